@@ -0,0 +1 @@
+"""Benchmarks for jshell and the jbox apps."""
@@ -0,0 +1,52 @@
+"""App benchmarks: rg, cat, head and tail throughput on generated data."""
+
+from pathlib import Path
+
+from bench.harness import (BIN_DIR, Results, repeat, throughput_mbs,
+                           timed)
+
+
+def tree_size(root: Path) -> int:
+    """Total size of the regular files under root."""
+    return sum(p.stat().st_size for p in root.rglob("*") if p.is_file())
+
+
+def run(results: Results, corpus: Path, tree: Path, quick: bool) -> None:
+    """Run the apps suite against the jbox multicall links."""
+    apps = {name: BIN_DIR / name for name in ("cat", "head", "tail", "rg")}
+    missing = [name for name, path in apps.items() if not path.exists()]
+    if missing:
+        results.skip("apps", f"{', '.join(missing)} not found; run make jbox")
+        return
+
+    repeats = 3 if quick else 7
+    size = corpus.stat().st_size
+    cat, head, tail, rg = (str(apps[n]) for n in ("cat", "head", "tail",
+                                                  "rg"))
+
+    results.add("apps.cat_mbs",
+                throughput_mbs(lambda: timed([cat, str(corpus)]), size,
+                               repeats), "MB/s", better="higher")
+    results.add("apps.head_all_lines_mbs",
+                throughput_mbs(lambda: timed([head, "-n", "100000000",
+                                              str(corpus)]),
+                               size, repeats), "MB/s", better="higher")
+    # tail reads from the end, so its cost should not grow with the file
+    results.add("apps.tail_10_lines_ms",
+                [t * 1000.0 for t in repeat(
+                    lambda: timed([tail, "-n", "10", str(corpus)]),
+                    repeats)], "ms")
+    results.add("apps.rg_literal_file_mbs",
+                throughput_mbs(lambda: timed([rg, "-c", "latency",
+                                              str(corpus)]),
+                               size, repeats), "MB/s", better="higher")
+    regex = "err[a-z]+ 0x[0-9a-f]+"
+    results.add("apps.rg_regex_file_mbs",
+                throughput_mbs(lambda: timed([rg, "-c", regex,
+                                              str(corpus)]),
+                               size, repeats), "MB/s", better="higher")
+    results.add("apps.rg_literal_tree_mbs",
+                throughput_mbs(lambda: timed([rg, "-l", "latency",
+                                              str(tree)]),
+                               tree_size(tree), repeats),
+                "MB/s", better="higher")
@@ -0,0 +1,88 @@
+"""ftpd benchmarks: RETR and STOR throughput over loopback."""
+
+import ftplib
+import os
+import shutil
+import subprocess
+import tempfile
+import time
+from pathlib import Path
+
+from bench.harness import BENCH_ENV, FTPD, Results, throughput_mbs
+
+
+PORT = 21621
+CHUNK = 256 * 1024
+
+
+def start_server(root: str) -> subprocess.Popen:
+    """Start ftpd serving root and wait until it accepts logins."""
+    proc = subprocess.Popen([str(FTPD), "-p", str(PORT), "-r", root],
+                            stdout=subprocess.DEVNULL,
+                            stderr=subprocess.PIPE, env=BENCH_ENV)
+    deadline = time.monotonic() + 5
+    while time.monotonic() < deadline:
+        if proc.poll() is not None:
+            raise RuntimeError("ftpd exited: "
+                               + proc.stderr.read().decode(errors="replace"))
+        try:
+            with ftplib.FTP() as ftp:
+                ftp.connect("127.0.0.1", PORT, timeout=1)
+                ftp.login()
+            return proc
+        except OSError:
+            time.sleep(0.05)
+    proc.kill()
+    raise RuntimeError("ftpd did not start")
+
+
+def retr(name: str) -> float:
+    """Download a file into nothing and return the transfer time."""
+    with ftplib.FTP() as ftp:
+        ftp.connect("127.0.0.1", PORT, timeout=30)
+        ftp.login()
+        start = time.perf_counter()
+        ftp.retrbinary(f"RETR {name}", lambda _data: None, blocksize=CHUNK)
+        return time.perf_counter() - start
+
+
+def stor(source: Path, name: str) -> float:
+    """Upload a file and return the transfer time."""
+    with ftplib.FTP() as ftp, open(source, "rb") as data:
+        ftp.connect("127.0.0.1", PORT, timeout=30)
+        ftp.login()
+        start = time.perf_counter()
+        ftp.storbinary(f"STOR {name}", data, blocksize=CHUNK)
+        return time.perf_counter() - start
+
+
+def run(results: Results, corpus: Path, quick: bool) -> None:
+    """Run the ftpd suite with the corpus as the transferred file."""
+    if not FTPD.exists():
+        results.skip("ftpd", f"{FTPD} not found; run make ftpd")
+        return
+
+    repeats = 3 if quick else 7
+    size = corpus.stat().st_size
+    root = tempfile.mkdtemp(prefix="jbox_bench_ftpd_")
+    try:
+        os.link(corpus, Path(root) / "corpus.txt")
+    except OSError:
+        shutil.copy(corpus, Path(root) / "corpus.txt")
+
+    proc = start_server(root)
+    try:
+        results.add("ftpd.retr_mbs",
+                    throughput_mbs(lambda: retr("corpus.txt"), size,
+                                   repeats), "MB/s", better="higher")
+        results.add("ftpd.stor_mbs",
+                    throughput_mbs(lambda: stor(corpus, "upload.txt"), size,
+                                   repeats), "MB/s", better="higher")
+    finally:
+        proc.terminate()
+        try:
+            proc.wait(timeout=2)
+        except subprocess.TimeoutExpired:
+            proc.kill()
+            proc.wait()
+        shutil.rmtree(root, ignore_errors=True)
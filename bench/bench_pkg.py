@@ -0,0 +1,72 @@
+"""pkg benchmarks: installing packages and running package commands."""
+
+import json
+import subprocess
+import tempfile
+import time
+from pathlib import Path
+
+from bench.harness import (BENCH_ENV, JSHELL, PKG, Results, per_op_ms,
+                           repeat)
+
+
+def make_tarball(work: Path, name: str) -> Path:
+    """Create a one-script package and build its tarball with pkg."""
+    pkg_dir = work / "src" / name
+    (pkg_dir / "bin").mkdir(parents=True)
+    exe = pkg_dir / "bin" / name
+    exe.write_text("#!/bin/sh\nexit 0\n")
+    exe.chmod(0o755)
+    (pkg_dir / "pkg.json").write_text(json.dumps({
+        "name": name,
+        "version": "1.0.0",
+        "description": f"Benchmark package {name}",
+        "files": [f"bin/{name}"],
+    }))
+
+    tarball = work / f"{name}-1.0.0.tar.gz"
+    subprocess.run([str(PKG), "build", str(pkg_dir), str(tarball)],
+                   check=True, capture_output=True, env=BENCH_ENV)
+    return tarball
+
+
+def install_all(tarballs: list) -> float:
+    """Install every tarball into a fresh HOME; return the time taken."""
+    with tempfile.TemporaryDirectory(prefix="jbox_bench_home_") as home:
+        env = {**BENCH_ENV, "HOME": home}
+        start = time.perf_counter()
+        for tarball in tarballs:
+            subprocess.run([str(PKG), "install", str(tarball)], check=True,
+                           capture_output=True, env=env)
+        return time.perf_counter() - start
+
+
+def run(results: Results, quick: bool) -> None:
+    """Run the pkg suite."""
+    if not PKG.exists():
+        results.skip("pkg", f"{PKG} not found; run make apps")
+        return
+
+    count = 5 if quick else 25
+    repeats = 3 if quick else 5
+    with tempfile.TemporaryDirectory(prefix="jbox_bench_pkg_") as tmp:
+        work = Path(tmp)
+        tarballs = [make_tarball(work, f"bench-pkg-{i:03d}")
+                    for i in range(count)]
+
+        results.add(f"pkg.install_{count}_packages_s",
+                    repeat(lambda: install_all(tarballs), repeats), "s")
+
+        if not JSHELL.exists():
+            results.skip("spawn.package_ms", f"{JSHELL} not found")
+            return
+
+        # A package command is an external spawn from its registered path
+        home = work / "home"
+        home.mkdir()
+        env = {**BENCH_ENV, "HOME": str(home)}
+        subprocess.run([str(PKG), "install", str(tarballs[0])], check=True,
+                       capture_output=True, env=env)
+        results.add("spawn.package_ms",
+                    per_op_ms(["bench-pkg-000"], 50 if quick else 500,
+                              repeats, env=env), "ms")
@@ -0,0 +1,89 @@
+"""Shell benchmarks: command dispatch, pipelines, capture, lookup, history."""
+
+import tempfile
+from pathlib import Path
+
+from bench.harness import (BENCH_ENV, JSHELL, Results, per_op_ms,
+                           repeat, shell_script, throughput_mbs, timed)
+
+
+def bench_spawn(results: Results, count: int, repeats: int) -> None:
+    """Latency of one command by the way it is run."""
+    cases = {
+        # cd must run on the main thread
+        "spawn.builtin_direct_ms": "cd .",
+        # pwd runs on a builtin thread
+        "spawn.builtin_thread_ms": "pwd",
+        # echo is linked into jbox and runs in-process
+        "spawn.linked_app_ms": "echo x",
+        "spawn.external_ms": "/bin/true",
+    }
+    for name, line in cases.items():
+        results.add(name, per_op_ms([line], count, repeats), "ms")
+
+
+def bench_pipelines(results: Results, corpus: Path, repeats: int,
+                    max_stages: int) -> None:
+    """Throughput of cat pipelines with a growing number of stages."""
+    size = corpus.stat().st_size
+    for stages in range(1, max_stages + 1):
+        for label, cat in (("linked", "cat"), ("external", "/bin/cat")):
+            line = " | ".join([f"{cat} {corpus}"] + [cat] * (stages - 1))
+            line += " > /dev/null"
+            samples = throughput_mbs(lambda: shell_script([line]), size,
+                                     repeats)
+            results.add(f"pipeline.{label}_{stages}_stages_mbs", samples,
+                        "MB/s", better="higher")
+
+
+def bench_capture(results: Results, count: int, repeats: int) -> None:
+    """Extra cost of capturing a command into a variable."""
+    plain = per_op_ms(["/bin/true"], count, repeats)
+    captured = per_op_ms(["X=/bin/true"], count, repeats)
+    results.add("capture.assignment_overhead_ms",
+                [max(c - p, 0.0) for c, p in zip(captured, plain)], "ms")
+    results.add("capture.builtin_assignment_ms",
+                per_op_ms(["X=pwd"], count, repeats), "ms")
+
+
+def bench_lookup(results: Results, count: int, repeats: int) -> None:
+    """Registry and PATH lookup through the type builtin."""
+    results.add("lookup.registry_builtin_ms",
+                per_op_ms(["type cd > /dev/null"], count, repeats), "ms")
+    results.add("lookup.path_external_ms",
+                per_op_ms(["type true > /dev/null"], count, repeats), "ms")
+
+
+def bench_history(results: Results, count: int, repeats: int) -> None:
+    """Cost of recording a line in the history file.
+
+    Interactive mode records every line it reads and -s does not, so the
+    difference per line is the history add.
+    """
+    # Distinct lines, so none is dropped as a repeat of the previous one
+    lines = [f"echo {i} > /dev/null" for i in range(count)]
+    script = ("\n".join(lines) + "\n").encode()
+
+    def sample() -> float:
+        with tempfile.TemporaryDirectory(prefix="jbox_bench_home_") as home:
+            env = {**BENCH_ENV, "HOME": home}
+            interactive = timed([str(JSHELL)], stdin=script, env=env)
+            batch = timed([str(JSHELL), "-s"], stdin=script, env=env)
+        return max(interactive - batch, 0.0) * 1000.0 / count
+
+    results.add("history.add_ms", repeat(sample, repeats), "ms")
+
+
+def run(results: Results, corpus: Path, quick: bool) -> None:
+    """Run the shell suite."""
+    if not JSHELL.exists():
+        results.skip("shell", f"{JSHELL} not found; run make jbox")
+        return
+
+    count = 50 if quick else 500
+    repeats = 3 if quick else 7
+    bench_spawn(results, count, repeats)
+    bench_pipelines(results, corpus, repeats, 4 if quick else 8)
+    bench_capture(results, count, repeats)
+    bench_lookup(results, count, repeats)
+    bench_history(results, count, repeats)
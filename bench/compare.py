@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+"""Compare benchmark results against a baseline and flag regressions.
+
+Usage:
+    python -m bench.compare BASELINE CURRENT [--threshold 0.10] [--json]
+
+A metric regresses when its median moves the wrong way by more than the
+threshold (a fraction of the baseline) and the two runs' sample ranges
+do not overlap, so one noisy sample does not fail the comparison. Exits
+1 if any metric regressed, 0 otherwise.
+"""
+
+import argparse
+import json
+import sys
+
+
+def judge(name: str, base: dict, cur: dict, threshold: float) -> dict:
+    """Classify one metric as ok, improved or regressed."""
+    change = (cur["value"] - base["value"]) / base["value"] \
+        if base["value"] else 0.0
+    worse = change > threshold if base["better"] == "lower" \
+        else change < -threshold
+    better = change < -threshold if base["better"] == "lower" \
+        else change > threshold
+    overlap = cur["min"] <= base["max"] and base["min"] <= cur["max"]
+
+    status = "ok"
+    if worse and not overlap:
+        status = "regressed"
+    elif better and not overlap:
+        status = "improved"
+
+    return {"metric": name, "unit": base["unit"], "baseline": base["value"],
+            "current": cur["value"], "change": change, "status": status}
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("baseline", help="stored baseline results")
+    parser.add_argument("current", help="results of the run to check")
+    parser.add_argument("--threshold", type=float, default=0.10,
+                        help="allowed change as a fraction (default: 0.10)")
+    parser.add_argument("--json", action="store_true",
+                        help="print the comparison as JSON")
+    args = parser.parse_args()
+
+    with open(args.baseline, encoding="utf-8") as f:
+        baseline = json.load(f)["metrics"]
+    with open(args.current, encoding="utf-8") as f:
+        current = json.load(f)["metrics"]
+
+    rows = [judge(name, baseline[name], current[name], args.threshold)
+            for name in sorted(baseline) if name in current]
+    missing = sorted(set(baseline) - set(current))
+    regressed = [row for row in rows if row["status"] == "regressed"]
+
+    if args.json:
+        json.dump({"metrics": rows, "missing": missing,
+                   "regressions": len(regressed)}, sys.stdout, indent=2)
+        sys.stdout.write("\n")
+    else:
+        for row in rows:
+            print(f"{row['metric']:<44} {row['baseline']:>10.3f} -> "
+                  f"{row['current']:>10.3f} {row['unit']:<5} "
+                  f"{row['change']:+7.1%}  {row['status']}")
+        for name in missing:
+            print(f"{name:<44} missing from current run")
+        print(f"{len(regressed)} regression(s) beyond "
+              f"{args.threshold:.0%}")
+
+    return 1 if regressed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
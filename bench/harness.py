@@ -0,0 +1,156 @@
+"""Timing, corpus and result helpers shared by the benchmark suites."""
+
+import os
+import random
+import statistics
+import subprocess
+import time
+from pathlib import Path
+from typing import Callable, Optional
+
+
+PROJECT_ROOT = Path(__file__).parent.parent
+# JBOX_BENCH_BIN selects a build profile's binaries (e.g. build/release/bin);
+# pkg is only built standalone, so it always comes from bin/
+BIN_DIR = Path(os.environ.get("JBOX_BENCH_BIN", PROJECT_ROOT / "bin"))
+JSHELL = BIN_DIR / "jshell"
+FTPD = BIN_DIR / "ftpd"
+PKG = PROJECT_ROOT / "bin" / "standalone-apps" / "pkg"
+
+# Sanitizer builds leak-check at exit, which would dominate short runs
+BENCH_ENV = {**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
+
+WORDS = ["alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf",
+         "hotel", "india", "juliet", "kilo", "lima", "mike", "november",
+         "oscar", "papa", "quebec", "romeo", "sierra", "tango", "error",
+         "warning", "request", "latency", "/usr/lib", "0x7f3a", "42"]
+
+
+class Results:
+    """Collects named measurements for one benchmark run.
+
+    Each metric keeps its samples, unit and direction ("lower" or
+    "higher" is better) so that compare.py can judge a change without
+    knowing the suite that produced it.
+    """
+
+    def __init__(self):
+        self.metrics = {}
+        self.skipped = {}
+
+    def add(self, name: str, samples: list, unit: str,
+            better: str = "lower") -> None:
+        """Record the samples of one metric; the median is its value."""
+        self.metrics[name] = {
+            "value": statistics.median(samples),
+            "min": min(samples),
+            "max": max(samples),
+            "samples": samples,
+            "unit": unit,
+            "better": better,
+        }
+
+    def skip(self, name: str, reason: str) -> None:
+        """Record that a suite or metric could not run here."""
+        self.skipped[name] = reason
+
+
+def repeat(func: Callable[[], float], count: int,
+           warmup: int = 1) -> list:
+    """Call func warmup + count times and return the last count results."""
+    for _ in range(warmup):
+        func()
+    return [func() for _ in range(count)]
+
+
+def timed(argv: list, stdin: Optional[bytes] = None,
+          env: Optional[dict] = None, cwd: Optional[str] = None) -> float:
+    """Run a command to completion, discarding its output.
+
+    Returns:
+        Elapsed wall time in seconds
+
+    Raises:
+        RuntimeError: If the command fails, so a broken benchmark is not
+            mistaken for a fast one
+    """
+    start = time.perf_counter()
+    result = subprocess.run(argv, input=stdin, stdout=subprocess.DEVNULL,
+                            stderr=subprocess.PIPE, env=env or BENCH_ENV,
+                            cwd=cwd)
+    elapsed = time.perf_counter() - start
+    if result.returncode != 0:
+        raise RuntimeError(f"{argv[0]} exited {result.returncode}: "
+                           f"{result.stderr.decode(errors='replace')[:200]}")
+    return elapsed
+
+
+def shell_script(lines: list, env: Optional[dict] = None,
+                 cwd: Optional[str] = None) -> float:
+    """Run lines as one jshell -s session and return its wall time."""
+    script = ("\n".join(lines) + "\n").encode()
+    return timed([str(JSHELL), "-s"], stdin=script, env=env, cwd=cwd)
+
+
+def per_op_ms(lines: list, count: int, repeats: int,
+              env: Optional[dict] = None, cwd: Optional[str] = None,
+              setup: Optional[list] = None) -> list:
+    """Cost of one command in a warm session, in milliseconds.
+
+    Runs setup + count copies of lines and setup alone in the same way;
+    the difference divided by count leaves out shell startup.
+    """
+    setup = setup or []
+    body = setup + lines * count
+
+    def sample() -> float:
+        loaded = shell_script(body, env=env, cwd=cwd)
+        empty = shell_script(setup, env=env, cwd=cwd)
+        return max(loaded - empty, 0.0) * 1000.0 / count
+
+    return repeat(sample, repeats)
+
+
+def throughput_mbs(func: Callable[[], float], size: int,
+                   repeats: int) -> list:
+    """Turn timed runs over size bytes into MB/s samples."""
+    return [size / (1024 * 1024) / max(t, 1e-9)
+            for t in repeat(func, repeats)]
+
+
+def generate_corpus(path: Path, size: int, seed: int = 1) -> Path:
+    """Write a reproducible log-like text file of about size bytes.
+
+    The same seed and size always give the same bytes, so runs on
+    different commits search identical data.
+    """
+    if path.exists() and path.stat().st_size >= size:
+        return path
+
+    rng = random.Random(seed)
+    path.parent.mkdir(parents=True, exist_ok=True)
+    written = 0
+    line_no = 0
+    with open(path, "w", encoding="ascii") as out:
+        while written < size:
+            words = " ".join(rng.choice(WORDS)
+                             for _ in range(rng.randint(4, 16)))
+            line = f"{line_no:08d} {words}\n"
+            out.write(line)
+            written += len(line)
+            line_no += 1
+    return path
+
+
+def generate_tree(root: Path, files: int, file_size: int,
+                  seed: int = 2) -> Path:
+    """Write a reproducible directory of files for recursive searches."""
+    marker = root / ".complete"
+    if marker.exists():
+        return root
+
+    for i in range(files):
+        sub = root / f"d{i % 16:02d}"
+        generate_corpus(sub / f"f{i:05d}.log", file_size, seed=seed + i)
+    marker.touch()
+    return root
@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+"""Run the jbox benchmark suites and write the results as JSON.
+
+Usage:
+    python -m bench.run [--quick] [--suite NAME ...] [--output FILE]
+
+Generated corpora are cached under bench/data, so repeated runs and runs
+on other commits measure the same bytes.
+"""
+
+import argparse
+import datetime
+import json
+import os
+import platform
+import subprocess
+import sys
+from pathlib import Path
+
+from bench import bench_apps, bench_ftpd, bench_pkg, bench_shell
+from bench.harness import (PROJECT_ROOT, Results, generate_corpus,
+                           generate_tree)
+
+
+SUITES = ("shell", "apps", "ftpd", "pkg")
+DATA_DIR = Path(__file__).parent / "data"
+
+
+def git_commit() -> str:
+    """Commit the binaries were presumably built from."""
+    try:
+        return subprocess.run(["git", "rev-parse", "--short", "HEAD"],
+                              cwd=PROJECT_ROOT, capture_output=True,
+                              text=True, check=True).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return "unknown"
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--quick", action="store_true",
+                        help="smaller data and fewer repeats, for a smoke run")
+    parser.add_argument("--suite", action="append", choices=SUITES,
+                        help="suite to run (repeatable; default: all)")
+    parser.add_argument("--output", default="-",
+                        help="where to write the JSON results (default: -)")
+    args = parser.parse_args()
+
+    suites = args.suite or list(SUITES)
+    mib = 1024 * 1024
+    corpus = generate_corpus(
+        DATA_DIR / ("corpus-8m.txt" if args.quick else "corpus-64m.txt"),
+        (8 if args.quick else 64) * mib)
+
+    results = Results()
+    for suite in suites:
+        print(f"bench: running {suite}", file=sys.stderr)
+        try:
+            if suite == "shell":
+                bench_shell.run(results, corpus, args.quick)
+            elif suite == "apps":
+                tree = generate_tree(DATA_DIR / "tree", 200 if args.quick
+                                     else 2000, 16 * 1024)
+                bench_apps.run(results, corpus, tree, args.quick)
+            elif suite == "ftpd":
+                bench_ftpd.run(results, corpus, args.quick)
+            elif suite == "pkg":
+                bench_pkg.run(results, args.quick)
+        except (OSError, RuntimeError, subprocess.CalledProcessError) as e:
+            results.skip(suite, f"failed: {e}")
+
+    report = {
+        "meta": {
+            "date": datetime.datetime.now().isoformat(timespec="seconds"),
+            "commit": git_commit(),
+            "host": platform.node(),
+            "machine": platform.machine(),
+            "cpus": os.cpu_count(),
+            "quick": args.quick,
+        },
+        "metrics": results.metrics,
+        "skipped": results.skipped,
+    }
+
+    text = json.dumps(report, indent=2) + "\n"
+    if args.output == "-":
+        sys.stdout.write(text)
+    else:
+        Path(args.output).parent.mkdir(parents=True, exist_ok=True)
+        Path(args.output).write_text(text)
+        print(f"bench: wrote {args.output}", file=sys.stderr)
+
+    for name, reason in results.skipped.items():
+        print(f"bench: skipped {name}: {reason}", file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -6,6 +6,7 @@ PROJECT_ROOT="$(dirname "$SCRIPT_DIR")"
 APPS_DIR="$PROJECT_ROOT/src/apps"
 OUTPUT_FILE="$PROJECT_ROOT/srv/pkg_repository/pkg_manifest.json"
 BASE_URL="${PKG_BASE_URL:-http://localhost:3000}"
+PKG="$PROJECT_ROOT/bin/standalone-apps/pkg"
 
 # Ensure output directory exists
 mkdir -p "$(dirname "$OUTPUT_FILE")"
@@ -33,7 +34,89 @@ done
         echo "    \"name\": \"$name\","
         echo "    \"latestVersion\": \"$version\","
         echo "    \"description\": \"$description\","
-        echo "    \"downloadUrl\": \"$BASE_URL/downloads/$name-$version.tar.gz\""
+        downloads="$PROJECT_ROOT/srv/pkg_repository/downloads"
+        tarball="$downloads/$name-$version.tar.gz"
+        if [ -f "$tarball" ]; then
+            echo "    \"downloadUrl\": \"$BASE_URL/downloads/$name-$version.tar.gz\","
+            echo -n "    \"sha256\": \"$(sha256sum "$tarball" | cut -d' ' -f1)\""
+        else
+            echo -n "    \"downloadUrl\": \"$BASE_URL/downloads/$name-$version.tar.gz\""
+        fi
+        # Prebuilt packages from 'make pkg-bin', named
+        # <name>-<version>-<platform>.tar.gz
+        binaries=()
+        for binary in "$downloads/$name-$version"-*.tar.gz; do
+            if [ -f "$binary" ]; then
+                binaries+=("$binary")
+            fi
+        done
+        if [ ${#binaries[@]} -gt 0 ]; then
+            echo ","
+            echo "    \"binaries\": ["
+            for j in "${!binaries[@]}"; do
+                file=$(basename "${binaries[$j]}")
+                platform=${file#"$name-$version-"}
+                platform=${platform%.tar.gz}
+                echo "      {"
+                echo "        \"platform\": \"$platform\","
+                echo "        \"downloadUrl\": \"$BASE_URL/downloads/$file\","
+                echo "        \"sha256\": \"$(sha256sum "${binaries[$j]}" | cut -d' ' -f1)\""
+                if [ $j -lt $((${#binaries[@]} - 1)) ]; then
+                    echo "      },"
+                else
+                    echo "      }"
+                fi
+            done
+            echo -n "    ]"
+        fi
+        # Deltas from each older version still in downloads, made with
+        # 'pkg delta' and kept: <name>-<old>-to-<version>[-<platform>].delta
+        deltas=()
+        if [ -x "$PKG" ]; then
+            for old_tarball in "$downloads/$name"-[0-9]*.tar.gz; do
+                [ -f "$old_tarball" ] || continue
+                rest=$(basename "$old_tarball" .tar.gz)
+                rest=${rest#"$name-"}
+                old=${rest%%-*}
+                platform=""
+                if [ "$rest" != "$old" ]; then
+                    platform=${rest#"$old-"}
+                fi
+                suffix=${platform:+-$platform}
+                new_tarball="$downloads/$name-$version$suffix.tar.gz"
+                newest=$(printf '%s\n%s\n' "$old" "$version" | sort -V | tail -n1)
+                if [ "$old" = "$version" ] || [ "$newest" != "$version" ] ||
+                   [ ! -f "$new_tarball" ]; then
+                    continue
+                fi
+                delta="$downloads/$name-$old-to-$version$suffix.delta"
+                if [ -f "$delta" ] ||
+                   "$PKG" delta "$old_tarball" "$new_tarball" "$delta" > /dev/null; then
+                    deltas+=("$old|$platform|$delta")
+                fi
+            done
+        fi
+        if [ ${#deltas[@]} -gt 0 ]; then
+            echo ","
+            echo "    \"deltas\": ["
+            for j in "${!deltas[@]}"; do
+                IFS='|' read -r old platform delta <<< "${deltas[$j]}"
+                echo "      {"
+                echo "        \"from\": \"$old\","
+                if [ -n "$platform" ]; then
+                    echo "        \"platform\": \"$platform\","
+                fi
+                echo "        \"downloadUrl\": \"$BASE_URL/downloads/$(basename "$delta")\","
+                echo "        \"sha256\": \"$(sha256sum "$delta" | cut -d' ' -f1)\""
+                if [ $j -lt $((${#deltas[@]} - 1)) ]; then
+                    echo "      },"
+                else
+                    echo "      }"
+                fi
+            done
+            echo -n "    ]"
+        fi
+        echo
         if [ $i -lt $((${#entries[@]} - 1)) ]; then
             echo "  },"
         else
@@ -44,3 +127,11 @@ done
 } > "$OUTPUT_FILE"
 
 echo "Generated $OUTPUT_FILE"
+
+# The same registry as static files (see src/pkg_srv/static.js), for any
+# HTTP server or CDN mirror to serve without the Node server
+if command -v node > /dev/null; then
+    node "$PROJECT_ROOT/src/pkg_srv/static.js" "$OUTPUT_FILE" \
+        "$PROJECT_ROOT/srv/pkg_repository/downloads" \
+        "$PROJECT_ROOT/srv/pkg_repository/static"
+fi
@@ -1,16 +1,33 @@
 /**
  * @file cmd_cat.c
  * @brief Implementation of the cat command for concatenating files.
+ *
+ * Files are streamed in fixed-size chunks in both plain and JSON mode,
+ * so memory use stays constant regardless of file size.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_aio.h"
+#include "utils/jbox_ctx.h"
 #include "utils/jbox_signals.h"
+#include "utils/jbox_json.h"
+
+
+/** Bytes moved per kernel copy call */
+#define CAT_CHUNK_SIZE (128 * 1024)
 
 
 /**
@@ -73,165 +90,270 @@ static void cat_print_usage(FILE *out) {
 
 
 /**
- * Escapes special characters in a string for JSON output.
+ * Passes the cat argtable to visit, for tool schemas derived from it.
  *
- * @param str     The input string to escape.
- * @param out     Buffer to write the escaped string to.
- * @param out_size Size of the output buffer.
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
  */
-static void escape_json_string(const char *str, char *out, size_t out_size) {
-  size_t j = 0;
-  for (size_t i = 0; str[i] && j < out_size - 1; i++) {
-    char c = str[i];
-    if (c == '"' || c == '\\') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = c;
-    } else if (c == '\n') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = 'n';
-    } else if (c == '\r') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = 'r';
-    } else if (c == '\t') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = 't';
-    } else {
-      out[j++] = c;
-    }
-  }
-  out[j] = '\0';
+static void cat_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  cat_args_t args;
+  build_cat_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_cat_argtable(&args);
 }
 
 
 /**
- * Reads entire content from a file stream into a dynamically allocated buffer.
+ * Tells the result cache what the output of cat depends on: the named
+ * files; not when reading stdin.
  *
- * @param fp       File pointer to read from.
- * @param out_size Optional pointer to receive the number of bytes read.
- * @return Newly allocated buffer containing the content, or NULL on error.
- *         Caller must free the returned buffer.
+ * @param argc Number of arguments
+ * @param argv Array of argument strings
+ * @return How this run may be cached
  */
-static char *read_stream_content(FILE *fp, size_t *out_size) {
-  size_t capacity = 4096;
-  size_t total = 0;
-  char *content = malloc(capacity);
-  if (!content) {
-    return NULL;
+static jshell_cmd_cache_t cat_cache_scope(int argc, char **argv) {
+  cat_args_t args;
+  build_cat_argtable(&args);
+  int nerrors = arg_parse(argc, argv, args.argtable);
+  jshell_cmd_cache_t scope = CMD_CACHE_NONE;
+  if (nerrors == 0 && args.help->count == 0
+      && args.files->count > 0) {
+    scope = CMD_CACHE_FILES;
   }
+  cleanup_cat_argtable(&args);
+  return scope;
+}
 
-  while (1) {
-    if (total + 4096 > capacity) {
-      capacity *= 2;
-      char *new_content = realloc(content, capacity);
-      if (!new_content) {
-        free(content);
-        return NULL;
+
+/**
+ * Ways of copying a plain-mode file to stdout, best first.
+ */
+typedef enum {
+  CAT_COPY_READ_WRITE,   /* Through a user-space buffer */
+  CAT_COPY_SPLICE,       /* Either end is a pipe */
+  CAT_COPY_FILE_RANGE,   /* Regular file to regular file */
+  CAT_COPY_SENDFILE      /* Regular file to a socket or device */
+} cat_copy_method_t;
+
+
+/**
+ * Writes a whole buffer to a descriptor, retrying short writes.
+ *
+ * @param fd  Descriptor to write to.
+ * @param buf Data to write.
+ * @param len Number of bytes to write.
+ * @return 0 on success, -1 on error with errno set.
+ */
+static int write_all(int fd, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR && !jbox_is_interrupted()) {
+        continue;
       }
-      content = new_content;
+      return -1;
     }
+    buf += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
 
-    size_t bytes_read = fread(content + total, 1, 4096, fp);
-    total += bytes_read;
-    if (bytes_read < 4096) {
-      break;
-    }
+
+/**
+ * Chooses how to copy from in_fd to out_fd.
+ *
+ * Regular files that report size 0 (/proc, /sys) are read normally,
+ * since kernel-side copies can see them as empty, and so is anything
+ * written to a terminal, where each read should show up as it arrives.
+ *
+ * @param in_fd  Source descriptor.
+ * @param out_fd Destination descriptor.
+ * @param same_file Set to true if both are the same regular file.
+ * @return The copy method to try first.
+ */
+static cat_copy_method_t pick_copy_method(int in_fd, int out_fd,
+                                          bool *same_file) {
+  struct stat in_st;
+  struct stat out_st;
+  *same_file = false;
+  if (fstat(in_fd, &in_st) != 0 || fstat(out_fd, &out_st) != 0) {
+    return CAT_COPY_READ_WRITE;
   }
 
-  content[total] = '\0';
-  if (out_size) {
-    *out_size = total;
+  if (S_ISREG(in_st.st_mode) && S_ISREG(out_st.st_mode)
+      && in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino) {
+    *same_file = true;
+    return CAT_COPY_READ_WRITE;
   }
 
-  return content;
+  if (isatty(out_fd)) {
+    return CAT_COPY_READ_WRITE;
+  }
+  if (S_ISFIFO(in_st.st_mode) || S_ISFIFO(out_st.st_mode)) {
+    return CAT_COPY_SPLICE;
+  }
+  if (!S_ISREG(in_st.st_mode) || in_st.st_size == 0) {
+    return CAT_COPY_READ_WRITE;
+  }
+  return S_ISREG(out_st.st_mode) ? CAT_COPY_FILE_RANGE : CAT_COPY_SENDFILE;
 }
 
 
 /**
- * Reads entire content of a file into a dynamically allocated buffer.
- *
- * Attempts to determine file size first for efficiency, but falls back
- * to streaming read for special files (e.g., /proc/* files).
+ * Copies a descriptor to stdout through user space, the next blocks of
+ * a regular file being read while each one is written.
  *
- * @param path     Path to the file to read.
- * @param out_size Optional pointer to receive the number of bytes read.
- * @return Newly allocated buffer containing the content, or NULL on error.
- *         Caller must free the returned buffer.
+ * @param in_fd        Descriptor to copy from.
+ * @param display_path Path to show in error messages.
+ * @return 0 on success, -1 on error.
  */
-static char *read_file_content(const char *path, size_t *out_size) {
-  FILE *fp = fopen(path, "rb");
-  if (!fp) {
-    return NULL;
+static int copy_read_write(int in_fd, const char *display_path) {
+  jbox_aio_t *aio = jbox_aio_open(in_fd, 0);
+  if (!aio) {
+    fprintf(stderr, "cat: %s\n", strerror(ENOMEM));
+    return -1;
   }
 
-  /* Try to get file size via seeking, fall back to streaming read */
-  int can_seek = (fseek(fp, 0, SEEK_END) == 0);
-  long size = can_seek ? ftell(fp) : -1;
-
-  if (can_seek && size > 0) {
-    /* Regular file with known size */
-    if (fseek(fp, 0, SEEK_SET) != 0) {
-      fclose(fp);
-      return NULL;
+  int result = 0;
+  while (!jbox_is_interrupted()) {
+    const char *data;
+    ssize_t n = jbox_aio_read(aio, &data);
+    if (n == 0) {
+      break;
     }
-
-    char *content = malloc((size_t)size + 1);
-    if (!content) {
-      fclose(fp);
-      return NULL;
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "cat: %s: %s\n", display_path, strerror(errno));
+      result = -1;
+      break;
     }
+    if (write_all(jbox_stdout_fd(), data, (size_t)n) != 0) {
+      /* The reader went away; inside jshell SIGPIPE is ignored, so this
+       * is where a standalone cat would have been killed quietly */
+      if (errno != EPIPE) {
+        fprintf(stderr, "cat: write error: %s\n", strerror(errno));
+      }
+      result = -1;
+      break;
+    }
+  }
 
-    size_t bytes_read = fread(content, 1, (size_t)size, fp);
-    fclose(fp);
+  jbox_aio_close(aio);
+  return result;
+}
 
-    content[bytes_read] = '\0';
-    if (out_size) {
-      *out_size = bytes_read;
-    }
 
-    return content;
+/**
+ * Copies a descriptor to stdout in fixed-size chunks.
+ *
+ * Uses splice/copy_file_range/sendfile where the descriptor types allow
+ * so the data never passes through user space, and falls back to
+ * copy_read_write() when the kernel refuses. Stops early on SIGINT.
+ * Errors are reported on stderr.
+ *
+ * @param in_fd        Descriptor to copy from.
+ * @param display_path Path to show in error messages.
+ * @return 0 on success, -1 on error.
+ */
+static int copy_to_stdout(int in_fd, const char *display_path) {
+  bool same_file;
+  cat_copy_method_t method = pick_copy_method(in_fd, jbox_stdout_fd(),
+                                              &same_file);
+  if (same_file) {
+    fprintf(stderr, "cat: %s: input file is output file\n", display_path);
+    return -1;
   }
-
-  /* Special file (e.g., /proc/*) or empty file - use streaming read */
-  if (can_seek) {
-    fseek(fp, 0, SEEK_SET);
+  if (method == CAT_COPY_READ_WRITE) {
+    return copy_read_write(in_fd, display_path);
   }
 
-  char *content = read_stream_content(fp, out_size);
-  fclose(fp);
-  return content;
+  while (!jbox_is_interrupted()) {
+    ssize_t n;
+    switch (method) {
+      case CAT_COPY_SPLICE:
+        n = splice(in_fd, NULL, jbox_stdout_fd(), NULL, CAT_CHUNK_SIZE,
+                   SPLICE_F_MOVE);
+        break;
+      case CAT_COPY_FILE_RANGE:
+        n = copy_file_range(in_fd, NULL, jbox_stdout_fd(), NULL,
+                            CAT_CHUNK_SIZE, 0);
+        break;
+      default:  /* CAT_COPY_SENDFILE */
+        n = sendfile(jbox_stdout_fd(), in_fd, NULL, CAT_CHUNK_SIZE);
+        break;
+    }
+
+    if (n == 0) {
+      return 0;
+    }
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      /* Kernel copy not supported for these files; offsets have advanced
+       * by whatever was copied, so plain reads carry on from there */
+      if (errno == EINVAL || errno == ENOSYS || errno == EXDEV
+          || errno == EOPNOTSUPP || errno == EBADF) {
+        return copy_read_write(in_fd, display_path);
+      }
+      /* The reader went away; inside jshell SIGPIPE is ignored, so this
+       * is where a standalone cat would have been killed quietly */
+      if (errno != EPIPE) {
+        fprintf(stderr, "cat: %s: %s\n", display_path, strerror(errno));
+      }
+      return -1;
+    }
+  }
+  return 0;
 }
 
 
 /**
- * Prints file content as a JSON object with path and content fields.
+ * Streams a descriptor as a JSON object with path and content fields.
+ *
+ * Content is read and escaped chunk by chunk, so memory use does not
+ * depend on the file size. A read error after output has started is
+ * reported in an "error" field next to the content read so far.
  *
- * @param path         Path to the file (for JSON output).
- * @param content      Content of the file.
- * @param content_size Size of the content in bytes.
+ * @param in_fd        Descriptor to read from.
+ * @param display_path Path to show in the JSON output.
+ * @return 0 on success, -1 on a read error.
  */
-static void print_json_content(const char *path, const char *content,
-                               size_t content_size) {
-  char escaped_path[512];
-  escape_json_string(path, escaped_path, sizeof(escaped_path));
-
-  size_t escaped_content_size = content_size * 2 + 1;
-  char *escaped_content = malloc(escaped_content_size);
-  if (!escaped_content) {
-    printf("{\"path\": \"%s\", \"error\": \"memory allocation failed\"}\n",
-           escaped_path);
-    return;
+static int print_json_content(int in_fd, const char *display_path) {
+  jbox_aio_t *aio = jbox_aio_open(in_fd, 0);
+
+  jbox_printf("{\"path\": ");
+  jbox_json_write_string(jbox_stdout(), display_path);
+  jbox_printf(", \"content\": \"");
+
+  int error = aio ? 0 : ENOMEM;
+  while (aio && !jbox_is_interrupted()) {
+    const char *data;
+    ssize_t n = jbox_aio_read(aio, &data);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      error = errno;
+      break;
+    }
+    if (n == 0) {
+      break;
+    }
+    jbox_json_write_escaped(jbox_stdout(), data, (size_t)n);
   }
+  jbox_aio_close(aio);
 
-  escape_json_string(content, escaped_content, escaped_content_size);
-
-  printf("{\"path\": \"%s\", \"content\": \"%s\"}",
-         escaped_path, escaped_content);
-
-  free(escaped_content);
+  jbox_printf("\"");
+  if (error != 0) {
+    jbox_printf(", \"error\": ");
+    jbox_json_write_string(jbox_stdout(), strerror(error));
+  }
+  jbox_printf("}");
+  return error != 0 ? -1 : 0;
 }
 
 
@@ -244,45 +366,46 @@ static void print_json_content(const char *path, const char *content,
  * @return 0 on success, 1 on error.
  */
 static int cat_file(const char *path, int show_json, int *first_entry) {
-  char *content = NULL;
-  size_t content_size = 0;
   int is_stdin = (path == NULL || strcmp(path, "-") == 0);
   const char *display_path = is_stdin ? "<stdin>" : path;
 
-  if (is_stdin) {
-    content = read_stream_content(stdin, &content_size);
-  } else {
-    content = read_file_content(path, &content_size);
+  int fd = is_stdin ? jbox_stdin_fd()
+                    : openat(jbox_cwd_fd(), path, O_RDONLY | O_CLOEXEC);
+
+  if (show_json) {
+    if (!*first_entry) {
+      jbox_printf(",\n");
+    }
+    *first_entry = 0;
   }
 
-  if (!content) {
+  if (fd < 0) {
     if (show_json) {
-      char escaped_path[512];
-      escape_json_string(display_path, escaped_path, sizeof(escaped_path));
-      if (!*first_entry) {
-        printf(",\n");
-      }
-      *first_entry = 0;
-      printf("{\"path\": \"%s\", \"error\": \"%s\"}",
-             escaped_path, strerror(errno));
+      const char *error = strerror(errno);
+      jbox_printf("{\"path\": ");
+      jbox_json_write_string(jbox_stdout(), display_path);
+      jbox_printf(", \"error\": ");
+      jbox_json_write_string(jbox_stdout(), error);
+      jbox_printf("}");
     } else {
       fprintf(stderr, "cat: %s: %s\n", display_path, strerror(errno));
     }
     return 1;
   }
 
+  int rc;
   if (show_json) {
-    if (!*first_entry) {
-      printf(",\n");
-    }
-    *first_entry = 0;
-    print_json_content(display_path, content, content_size);
+    rc = print_json_content(fd, display_path);
   } else {
-    fwrite(content, 1, content_size, stdout);
+    /* Raw descriptor writes follow; keep earlier stdio output in order */
+    fflush(jbox_stdout());
+    rc = copy_to_stdout(fd, display_path);
   }
 
-  free(content);
-  return 0;
+  if (!is_stdin) {
+    close(fd);
+  }
+  return rc != 0 ? 1 : 0;
 }
 
 
@@ -306,7 +429,7 @@ static int cat_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    cat_print_usage(stdout);
+    cat_print_usage(jbox_stdout());
     cleanup_cat_argtable(&args);
     return 0;
   }
@@ -323,7 +446,7 @@ static int cat_run(int argc, char **argv) {
   int result = 0;
 
   if (show_json) {
-    printf("[\n");
+    jbox_printf("[\n");
   }
 
   if (args.files->count == 0) {
@@ -344,8 +467,12 @@ static int cat_run(int argc, char **argv) {
     }
   }
 
+  if (result == 0 && jbox_is_interrupted()) {
+    result = 130;  /* Interrupted mid-file */
+  }
+
   if (show_json) {
-    printf("\n]\n");
+    jbox_printf("\n]\n");
   }
 
   cleanup_cat_argtable(&args);
@@ -364,7 +491,9 @@ const jshell_cmd_spec_t cmd_cat_spec = {
                "path and content fields.",
   .type = CMD_EXTERNAL,
   .run = cat_run,
-  .print_usage = cat_print_usage
+  .print_usage = cat_print_usage,
+  .describe_args = cat_describe_args,
+  .cache_scope = cat_cache_scope
 };
 
 
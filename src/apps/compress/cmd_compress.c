@@ -0,0 +1,922 @@
+/**
+ * @file cmd_compress.c
+ * @brief Compress command implementation for jshell.
+ *
+ * Compresses standard input (or a file) to gzip or zstd on every core,
+ * like pigz and pzstd, and decompresses either format. The input is cut
+ * into blocks that are compressed independently, each into a complete
+ * gzip member or zstd frame; concatenated, they are an ordinary .gz or
+ * .zst file that gzip and zstd read as one stream.
+ *
+ * Each block also records its own compressed size where other tools
+ * ignore it: in a "JB" extra field of the gzip header, or in a zstd
+ * skippable frame just before the frame. That lets decompression cut the
+ * input back into blocks without inflating it, so it runs in parallel
+ * too. Input without these sizes is decompressed as a plain stream.
+ *
+ * The calling thread reads blocks into a ring of slots and writes the
+ * results out in order; worker threads take filled slots in turn. The
+ * ring bounds memory to a few blocks per thread however large the input.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <zstd.h>
+
+#include "argtable3.h"
+#include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_ctx.h"
+#include "utils/jbox_gzip.h"
+#include "utils/jbox_signals.h"
+
+
+/** Upper bound on worker threads */
+#define COMPRESS_MAX_WORKERS 64
+
+/** Input bytes per zstd block; larger than gzip's, as zstd looks
+ *  further back */
+#define COMPRESS_ZSTD_BLOCK (4 * 1024 * 1024)
+
+/** Largest block accepted when decompressing in parallel */
+#define COMPRESS_MAX_BLOCK (256 * 1024 * 1024)
+
+/** Buffer size for streaming decompression */
+#define COMPRESS_STREAM_CHUNK (256 * 1024)
+
+/** Bytes of the zstd skippable frame written before each block */
+#define ZSTD_SIZE_FRAME_LEN 12
+
+/** Magic of the skippable frame holding a block's size */
+#define ZSTD_SIZE_MAGIC 0x184D2A50u
+
+
+typedef enum {
+  COMPRESS_GZIP,
+  COMPRESS_ZSTD
+} compress_format_t;
+
+/** What to do, shared by all threads */
+typedef struct {
+  compress_format_t format;
+  bool decompress;
+  int level;
+} compress_opts_t;
+
+/** One block in the ring */
+typedef struct {
+  unsigned char *in;
+  size_t in_len;
+  size_t in_cap;
+  unsigned char *out;
+  size_t out_len;
+  size_t out_cap;
+  size_t raw_len;           /* Decompressed size, when decompressing */
+  bool done;
+  bool failed;
+} compress_slot_t;
+
+/** Ring of slots between the reading thread and the workers */
+typedef struct {
+  const compress_opts_t *opts;
+  compress_slot_t *slots;
+  size_t count;
+  size_t filled;            /* Blocks handed to the workers so far */
+  size_t taken;             /* Blocks taken by a worker so far */
+  bool closed;              /* No more blocks will come */
+  pthread_mutex_t lock;
+  pthread_cond_t work;      /* A block was filled, or the ring closed */
+  pthread_cond_t done;      /* A block was finished */
+} compress_ring_t;
+
+/** Codec state a worker keeps between blocks */
+typedef struct {
+  compress_ring_t *ring;
+  jbox_gzip_deflater_t *deflater;
+  z_stream z;               /* Inflate state */
+  bool z_ready;
+  ZSTD_CCtx *cctx;
+  ZSTD_DCtx *dctx;
+} compress_worker_t;
+
+/** The input, with bytes read ahead while detecting the format */
+typedef struct {
+  int fd;
+  unsigned char carry[8];
+  size_t carry_len;
+  size_t carry_off;
+} compress_input_t;
+
+
+typedef struct {
+  struct arg_lit *help;
+  struct arg_lit *decompress;
+  struct arg_str *format;
+  struct arg_int *level;
+  struct arg_int *threads;
+  struct arg_file *output;
+  struct arg_lit *force;
+  struct arg_file *file;
+  struct arg_end *end;
+  void *argtable[9];
+} compress_args_t;
+
+
+/**
+ * Build the argument table for the compress command.
+ * @param args Pointer to compress_args_t structure to populate.
+ */
+static void build_compress_argtable(compress_args_t *args) {
+  args->help       = arg_lit0("h", "help", "display this help and exit");
+  args->decompress = arg_lit0("d", "decompress",
+                              "decompress gzip or zstd input");
+  args->format     = arg_str0("F", "format", "FORMAT",
+                              "gzip (default) or zstd");
+  args->level      = arg_int0("l", "level", "N",
+                              "compression level (gzip 1-9, zstd 1-19)");
+  args->threads    = arg_int0("j", "threads", "N",
+                              "worker threads (default: one per core)");
+  args->output     = arg_file0("o", "output", "FILE",
+                               "write to FILE instead of standard output");
+  args->force      = arg_lit0("f", "force",
+                              "write compressed data to a terminal");
+  args->file       = arg_file0(NULL, NULL, "FILE",
+                               "input (default: standard input)");
+  args->end        = arg_end(20);
+
+  args->argtable[0] = args->help;
+  args->argtable[1] = args->decompress;
+  args->argtable[2] = args->format;
+  args->argtable[3] = args->level;
+  args->argtable[4] = args->threads;
+  args->argtable[5] = args->output;
+  args->argtable[6] = args->force;
+  args->argtable[7] = args->file;
+  args->argtable[8] = args->end;
+}
+
+
+/**
+ * Clean up and free the argument table.
+ * @param args Pointer to compress_args_t structure to clean up.
+ */
+static void cleanup_compress_argtable(compress_args_t *args) {
+  arg_freetable(args->argtable,
+                sizeof(args->argtable) / sizeof(args->argtable[0]));
+}
+
+
+/**
+ * Print usage information for the compress command.
+ * @param out Output stream to write usage information to.
+ */
+static void compress_print_usage(FILE *out) {
+  compress_args_t args;
+  build_compress_argtable(&args);
+  fprintf(out, "Usage: compress");
+  arg_print_syntax(out, args.argtable, "\n");
+  fprintf(out, "Compress or decompress gzip and zstd on all cores.\n\n");
+  fprintf(out, "Options:\n");
+  arg_print_glossary(out, args.argtable, "  %-26s %s\n");
+  cleanup_compress_argtable(&args);
+}
+
+
+/**
+ * Passes the compress argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void compress_describe_args(jshell_argtable_visit_fn visit,
+                                   void *userdata) {
+  compress_args_t args;
+  build_compress_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_compress_argtable(&args);
+}
+
+
+// ---------------------------------------------------------------------------
+// I/O
+// ---------------------------------------------------------------------------
+
+static void put_le32(unsigned char *p, uint32_t v) {
+  p[0] = (unsigned char)v;
+  p[1] = (unsigned char)(v >> 8);
+  p[2] = (unsigned char)(v >> 16);
+  p[3] = (unsigned char)(v >> 24);
+}
+
+static uint32_t get_le32(const unsigned char *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+
+/**
+ * Read up to len bytes, stopping early only at end of input.
+ * @return Bytes read, or -1 on error or interrupt (errno set).
+ */
+static ssize_t read_full(compress_input_t *in, void *buf, size_t len) {
+  unsigned char *p = buf;
+  size_t got = 0;
+
+  if (in->carry_off < in->carry_len) {
+    size_t n = in->carry_len - in->carry_off;
+    if (n > len) n = len;
+    memcpy(p, in->carry + in->carry_off, n);
+    in->carry_off += n;
+    got = n;
+  }
+  while (got < len) {
+    ssize_t n = read(in->fd, p + got, len - got);
+    if (n < 0) {
+      if (errno == EINTR && !jbox_is_interrupted()) continue;
+      return -1;
+    }
+    if (n == 0) break;
+    got += (size_t)n;
+  }
+  return (ssize_t)got;
+}
+
+
+static int write_all(int fd, const void *buf, size_t len) {
+  const unsigned char *p = buf;
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR && !jbox_is_interrupted()) continue;
+      return -1;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+
+static int grow(unsigned char **buf, size_t *cap, size_t need) {
+  if (need <= *cap) return 0;
+  unsigned char *grown = realloc(*buf, need);
+  if (!grown) return -1;
+  *buf = grown;
+  *cap = need;
+  return 0;
+}
+
+
+// ---------------------------------------------------------------------------
+// Blocks
+// ---------------------------------------------------------------------------
+
+/**
+ * Compress a block into one gzip member whose header carries its size.
+ * @return 0 on success, -1 on error.
+ */
+static int gzip_block(compress_worker_t *w, compress_slot_t *slot) {
+  if (!w->deflater &&
+      !(w->deflater = jbox_gzip_deflater_new(w->ring->opts->level))) {
+    return -1;
+  }
+  return jbox_gzip_member(w->deflater, slot->in, slot->in_len, &slot->out,
+                          &slot->out_cap, &slot->out_len);
+}
+
+
+/**
+ * Compress a block into one zstd frame, after a skippable frame that
+ * holds its size.
+ * @return 0 on success, -1 on error.
+ */
+static int zstd_block(compress_worker_t *w, compress_slot_t *slot) {
+  if (!w->cctx && !(w->cctx = ZSTD_createCCtx())) return -1;
+
+  size_t bound = ZSTD_SIZE_FRAME_LEN + ZSTD_compressBound(slot->in_len);
+  if (grow(&slot->out, &slot->out_cap, bound) != 0) return -1;
+
+  size_t n = ZSTD_compressCCtx(w->cctx, slot->out + ZSTD_SIZE_FRAME_LEN,
+                               bound - ZSTD_SIZE_FRAME_LEN, slot->in,
+                               slot->in_len, w->ring->opts->level);
+  if (ZSTD_isError(n)) return -1;
+
+  put_le32(slot->out, ZSTD_SIZE_MAGIC);
+  put_le32(slot->out + 4, 4);
+  put_le32(slot->out + 8, (uint32_t)n);
+  slot->out_len = ZSTD_SIZE_FRAME_LEN + n;
+  return 0;
+}
+
+
+/**
+ * Inflate one gzip member of known decompressed size.
+ * @return 0 on success, -1 on error.
+ */
+static int gunzip_block(compress_worker_t *w, compress_slot_t *slot) {
+  if (!w->z_ready) {
+    if (inflateInit2(&w->z, 16 + MAX_WBITS) != Z_OK) return -1;
+    w->z_ready = true;
+  } else {
+    inflateReset(&w->z);
+  }
+  /* One spare byte, to tell a member longer than it claims */
+  if (grow(&slot->out, &slot->out_cap, slot->raw_len + 1) != 0) return -1;
+
+  w->z.next_in = slot->in;
+  w->z.avail_in = (uInt)slot->in_len;
+  w->z.next_out = slot->out;
+  w->z.avail_out = (uInt)(slot->raw_len + 1);
+  if (inflate(&w->z, Z_FINISH) != Z_STREAM_END ||
+      w->z.total_out != slot->raw_len || w->z.avail_in != 0) {
+    return -1;
+  }
+  slot->out_len = slot->raw_len;
+  return 0;
+}
+
+
+/**
+ * Decompress one zstd frame of known decompressed size.
+ * @return 0 on success, -1 on error.
+ */
+static int unzstd_block(compress_worker_t *w, compress_slot_t *slot) {
+  if (!w->dctx && !(w->dctx = ZSTD_createDCtx())) return -1;
+  if (grow(&slot->out, &slot->out_cap, slot->raw_len + 1) != 0) return -1;
+
+  size_t n = ZSTD_decompressDCtx(w->dctx, slot->out, slot->raw_len + 1,
+                                 slot->in, slot->in_len);
+  if (ZSTD_isError(n) || n != slot->raw_len) return -1;
+  slot->out_len = n;
+  return 0;
+}
+
+
+static void *compress_worker(void *arg) {
+  compress_worker_t *w = arg;
+  compress_ring_t *ring = w->ring;
+  const compress_opts_t *opts = ring->opts;
+
+  pthread_mutex_lock(&ring->lock);
+  for (;;) {
+    while (!ring->closed && ring->taken == ring->filled) {
+      pthread_cond_wait(&ring->work, &ring->lock);
+    }
+    if (ring->taken == ring->filled) break;
+    compress_slot_t *slot = &ring->slots[ring->taken++ % ring->count];
+    pthread_mutex_unlock(&ring->lock);
+
+    int rc;
+    if (opts->format == COMPRESS_GZIP) {
+      rc = opts->decompress ? gunzip_block(w, slot) : gzip_block(w, slot);
+    } else {
+      rc = opts->decompress ? unzstd_block(w, slot) : zstd_block(w, slot);
+    }
+
+    pthread_mutex_lock(&ring->lock);
+    slot->failed = rc != 0;
+    slot->done = true;
+    pthread_cond_broadcast(&ring->done);
+  }
+  pthread_mutex_unlock(&ring->lock);
+
+  if (w->z_ready) inflateEnd(&w->z);
+  jbox_gzip_deflater_free(w->deflater);
+  ZSTD_freeCCtx(w->cctx);
+  ZSTD_freeDCtx(w->dctx);
+  return NULL;
+}
+
+
+// ---------------------------------------------------------------------------
+// Reading blocks
+// ---------------------------------------------------------------------------
+
+/** What reading the next block found */
+enum {
+  READ_EOF = 0,
+  READ_BLOCK = 1,
+  READ_ERROR = -1,
+  READ_STREAM = 2,          /* Not one of our blocks: the bytes read so
+                               far are in the slot, to decode as a
+                               stream */
+};
+
+/**
+ * Read the next block of input to compress.
+ * @param first Whether this is the first block; empty input still
+ *        becomes one (empty) block
+ */
+static int read_plain_block(compress_input_t *in, compress_slot_t *slot,
+                            size_t block, bool first) {
+  if (grow(&slot->in, &slot->in_cap, block) != 0) {
+    errno = ENOMEM;
+    return READ_ERROR;
+  }
+  ssize_t n = read_full(in, slot->in, block);
+  if (n < 0) return READ_ERROR;
+  slot->in_len = (size_t)n;
+  return n > 0 || first ? READ_BLOCK : READ_EOF;
+}
+
+
+/**
+ * Read the next gzip member, if its header says how long it is.
+ */
+static int read_gzip_block(compress_input_t *in, compress_slot_t *slot) {
+  if (grow(&slot->in, &slot->in_cap, JBOX_GZIP_HEADER_LEN) != 0) {
+    errno = ENOMEM;
+    return READ_ERROR;
+  }
+  ssize_t n = read_full(in, slot->in, JBOX_GZIP_HEADER_LEN);
+  if (n < 0) return READ_ERROR;
+  slot->in_len = (size_t)n;
+  if (n == 0) return READ_EOF;
+  if (n < JBOX_GZIP_HEADER_LEN) return READ_STREAM;
+
+  size_t len = jbox_gzip_member_size(slot->in);
+  if (len == 0 || len > COMPRESS_MAX_BLOCK) return READ_STREAM;
+
+  if (grow(&slot->in, &slot->in_cap, len) != 0) {
+    errno = ENOMEM;
+    return READ_ERROR;
+  }
+  n = read_full(in, slot->in + JBOX_GZIP_HEADER_LEN,
+                len - JBOX_GZIP_HEADER_LEN);
+  if (n < 0) return READ_ERROR;
+  slot->in_len = JBOX_GZIP_HEADER_LEN + (size_t)n;
+  if (slot->in_len < len) return READ_STREAM;
+  slot->raw_len = get_le32(slot->in + len - 4);
+  return READ_BLOCK;
+}
+
+
+/**
+ * Read the next zstd frame, if a skippable frame before it says how long
+ * it is.
+ */
+static int read_zstd_block(compress_input_t *in, compress_slot_t *slot) {
+  if (grow(&slot->in, &slot->in_cap, ZSTD_SIZE_FRAME_LEN) != 0) {
+    errno = ENOMEM;
+    return READ_ERROR;
+  }
+  ssize_t n = read_full(in, slot->in, ZSTD_SIZE_FRAME_LEN);
+  if (n < 0) return READ_ERROR;
+  slot->in_len = (size_t)n;
+  if (n == 0) return READ_EOF;
+
+  if (n < ZSTD_SIZE_FRAME_LEN || get_le32(slot->in) != ZSTD_SIZE_MAGIC ||
+      get_le32(slot->in + 4) != 4) {
+    return READ_STREAM;
+  }
+  size_t len = get_le32(slot->in + 8);
+  if (len > COMPRESS_MAX_BLOCK) return READ_STREAM;
+
+  /* The frame goes where the size frame was, as that is skipped */
+  if (grow(&slot->in, &slot->in_cap, ZSTD_SIZE_FRAME_LEN + len) != 0) {
+    errno = ENOMEM;
+    return READ_ERROR;
+  }
+  n = read_full(in, slot->in + ZSTD_SIZE_FRAME_LEN, len);
+  if (n < 0) return READ_ERROR;
+  slot->in_len = ZSTD_SIZE_FRAME_LEN + (size_t)n;
+  if ((size_t)n < len) return READ_STREAM;
+
+  unsigned long long raw = ZSTD_getFrameContentSize(
+      slot->in + ZSTD_SIZE_FRAME_LEN, len);
+  if (raw == ZSTD_CONTENTSIZE_UNKNOWN || raw == ZSTD_CONTENTSIZE_ERROR ||
+      raw > COMPRESS_MAX_BLOCK) {
+    return READ_STREAM;
+  }
+  memmove(slot->in, slot->in + ZSTD_SIZE_FRAME_LEN, len);
+  slot->in_len = len;
+  slot->raw_len = (size_t)raw;
+  return READ_BLOCK;
+}
+
+
+// ---------------------------------------------------------------------------
+// Streaming decompression
+// ---------------------------------------------------------------------------
+
+/**
+ * Decompress the rest of the input on the calling thread, starting with
+ * bytes already read.
+ * @return 0 on success, -1 on error (printed), -2 on interrupt.
+ */
+static int decompress_stream(compress_format_t format, compress_input_t *in,
+                             const unsigned char *prefix, size_t prefix_len,
+                             int out_fd) {
+  unsigned char *ibuf = malloc(COMPRESS_STREAM_CHUNK);
+  unsigned char *obuf = malloc(COMPRESS_STREAM_CHUNK);
+  z_stream z = {0};
+  ZSTD_DCtx *dctx = NULL;
+  int rc = 0;
+  bool z_ready = false;
+
+  if (!ibuf || !obuf) {
+    fprintf(stderr, "compress: out of memory\n");
+    rc = -1;
+  } else if (format == COMPRESS_GZIP) {
+    z_ready = inflateInit2(&z, 16 + MAX_WBITS) == Z_OK;
+    if (!z_ready) rc = -1;
+  } else {
+    dctx = ZSTD_createDCtx();
+    if (!dctx) rc = -1;
+  }
+  if (rc != 0 && ibuf && obuf) fprintf(stderr, "compress: out of memory\n");
+
+  const unsigned char *data = prefix;
+  size_t len = prefix_len;
+  bool at_end = false;      /* The last frame or member ended */
+  bool any = false;
+  while (rc == 0) {
+    if (len == 0) {
+      if (jbox_is_interrupted()) {
+        rc = -2;
+        break;
+      }
+      ssize_t n = read_full(in, ibuf, COMPRESS_STREAM_CHUNK);
+      if (n < 0) {
+        if (jbox_is_interrupted()) rc = -2;
+        else fprintf(stderr, "compress: read error: %s\n", strerror(errno));
+        if (rc == 0) rc = -1;
+        break;
+      }
+      if (n == 0) break;
+      data = ibuf;
+      len = (size_t)n;
+    }
+    any = true;
+
+    size_t used, produced;
+    if (format == COMPRESS_GZIP) {
+      if (at_end) inflateReset(&z);
+      z.next_in = (Bytef *)data;
+      z.avail_in = (uInt)len;
+      z.next_out = obuf;
+      z.avail_out = COMPRESS_STREAM_CHUNK;
+      int zrc = inflate(&z, Z_NO_FLUSH);
+      if (zrc != Z_OK && zrc != Z_STREAM_END && zrc != Z_BUF_ERROR) {
+        fprintf(stderr, "compress: invalid compressed data\n");
+        rc = -1;
+        break;
+      }
+      at_end = zrc == Z_STREAM_END;
+      used = len - z.avail_in;
+      produced = COMPRESS_STREAM_CHUNK - z.avail_out;
+    } else {
+      ZSTD_inBuffer zin = { data, len, 0 };
+      ZSTD_outBuffer zout = { obuf, COMPRESS_STREAM_CHUNK, 0 };
+      size_t zrc = ZSTD_decompressStream(dctx, &zout, &zin);
+      if (ZSTD_isError(zrc)) {
+        fprintf(stderr, "compress: invalid compressed data\n");
+        rc = -1;
+        break;
+      }
+      at_end = zrc == 0;
+      used = zin.pos;
+      produced = zout.pos;
+    }
+    data += used;
+    len -= used;
+
+    if (produced > 0 && write_all(out_fd, obuf, produced) != 0) {
+      if (errno != EPIPE) {
+        fprintf(stderr, "compress: write error: %s\n", strerror(errno));
+      }
+      rc = -1;
+    }
+  }
+  if (rc == 0 && any && !at_end) {
+    fprintf(stderr, "compress: unexpected end of input\n");
+    rc = -1;
+  }
+
+  if (z_ready) inflateEnd(&z);
+  ZSTD_freeDCtx(dctx);
+  free(ibuf);
+  free(obuf);
+  return rc;
+}
+
+
+// ---------------------------------------------------------------------------
+// Pipeline
+// ---------------------------------------------------------------------------
+
+/**
+ * Wait for the oldest block in the ring and write it out.
+ * @return 0 on success, -1 on error (printed).
+ */
+static int write_oldest(compress_ring_t *ring, size_t *written, int out_fd) {
+  compress_slot_t *slot = &ring->slots[*written % ring->count];
+  pthread_mutex_lock(&ring->lock);
+  while (!slot->done) pthread_cond_wait(&ring->done, &ring->lock);
+  pthread_mutex_unlock(&ring->lock);
+
+  if (slot->failed) {
+    fprintf(stderr, ring->opts->decompress
+                        ? "compress: invalid compressed data\n"
+                        : "compress: out of memory\n");
+    return -1;
+  }
+  if (write_all(out_fd, slot->out, slot->out_len) != 0) {
+    if (errno != EPIPE) {
+      fprintf(stderr, "compress: write error: %s\n", strerror(errno));
+    }
+    return -1;
+  }
+  slot->done = false;
+  (*written)++;
+  return 0;
+}
+
+
+/**
+ * Run the input through the workers to out_fd.
+ * @return 0 on success, -1 on error (printed), -2 on interrupt.
+ */
+static int run_pipeline(const compress_opts_t *opts, compress_input_t *in,
+                        int out_fd, int workers) {
+  compress_ring_t ring = { .opts = opts, .count = (size_t)workers * 2 + 1 };
+  ring.slots = calloc(ring.count, sizeof(compress_slot_t));
+  compress_worker_t *states = calloc((size_t)workers,
+                                     sizeof(compress_worker_t));
+  pthread_t threads[COMPRESS_MAX_WORKERS];
+  int started = 0;
+  if (!ring.slots || !states) {
+    fprintf(stderr, "compress: out of memory\n");
+    free(ring.slots);
+    free(states);
+    return -1;
+  }
+  pthread_mutex_init(&ring.lock, NULL);
+  pthread_cond_init(&ring.work, NULL);
+  pthread_cond_init(&ring.done, NULL);
+  for (int i = 0; i < workers; i++) {
+    states[i].ring = &ring;
+    if (pthread_create(&threads[started], NULL, compress_worker,
+                       &states[i]) == 0) {
+      started++;
+    }
+  }
+
+  int rc = started > 0 ? 0 : -1;
+  if (rc != 0) fprintf(stderr, "compress: cannot start threads\n");
+  size_t block = opts->format == COMPRESS_GZIP ? JBOX_GZIP_BLOCK
+                                               : COMPRESS_ZSTD_BLOCK;
+  size_t written = 0;
+  bool eof = false;
+  compress_slot_t *stream_slot = NULL;
+  while (rc == 0) {
+    if (jbox_is_interrupted()) {
+      rc = -2;
+      break;
+    }
+
+    /* Keep the ring full; write once it is, or once the input ended */
+    if (!eof && ring.filled - written < ring.count) {
+      compress_slot_t *slot = &ring.slots[ring.filled % ring.count];
+      int got;
+      if (!opts->decompress) {
+        got = read_plain_block(in, slot, block, ring.filled == 0);
+      } else if (opts->format == COMPRESS_GZIP) {
+        got = read_gzip_block(in, slot);
+      } else {
+        got = read_zstd_block(in, slot);
+      }
+
+      if (got == READ_BLOCK) {
+        pthread_mutex_lock(&ring.lock);
+        ring.filled++;
+        pthread_cond_signal(&ring.work);
+        pthread_mutex_unlock(&ring.lock);
+        continue;
+      }
+      if (got == READ_ERROR) {
+        if (jbox_is_interrupted()) {
+          rc = -2;
+        } else {
+          fprintf(stderr, "compress: read error: %s\n", strerror(errno));
+          rc = -1;
+        }
+        break;
+      }
+      if (got == READ_STREAM) stream_slot = slot;
+      eof = true;
+      continue;
+    }
+    if (written == ring.filled) break;
+    rc = write_oldest(&ring, &written, out_fd);
+  }
+
+  /* Not our blocks from here on: decode the rest as a stream, after the
+   * blocks before it */
+  if (rc == 0 && stream_slot) {
+    rc = decompress_stream(opts->format, in, stream_slot->in,
+                           stream_slot->in_len, out_fd);
+  }
+
+  pthread_mutex_lock(&ring.lock);
+  ring.closed = true;
+  ring.filled = ring.taken;         /* Drop blocks nobody took */
+  pthread_cond_broadcast(&ring.work);
+  pthread_mutex_unlock(&ring.lock);
+  for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+
+  pthread_cond_destroy(&ring.work);
+  pthread_cond_destroy(&ring.done);
+  pthread_mutex_destroy(&ring.lock);
+  for (size_t i = 0; i < ring.count; i++) {
+    free(ring.slots[i].in);
+    free(ring.slots[i].out);
+  }
+  free(ring.slots);
+  free(states);
+  return rc;
+}
+
+
+/**
+ * Tell gzip from zstd by the first bytes of the input, keeping them to be
+ * read again.
+ * @return 0 on success, -1 on error (printed).
+ */
+static int detect_format(compress_input_t *in, compress_format_t *format) {
+  ssize_t n = read_full(in, in->carry, 4);
+  if (n < 0) {
+    fprintf(stderr, "compress: read error: %s\n", strerror(errno));
+    return -1;
+  }
+  in->carry_len = (size_t)n;
+  in->carry_off = 0;
+
+  const unsigned char *p = in->carry;
+  if (n == 0) return 0;     /* Empty input decompresses to nothing */
+  if (n >= 2 && p[0] == 0x1f && p[1] == 0x8b) {
+    *format = COMPRESS_GZIP;
+    return 0;
+  }
+  if (n == 4) {
+    uint32_t magic = get_le32(p);
+    if (magic == 0xFD2FB528u || (magic & 0xFFFFFFF0u) == ZSTD_SIZE_MAGIC) {
+      *format = COMPRESS_ZSTD;
+      return 0;
+    }
+  }
+  fprintf(stderr, "compress: input is not in gzip or zstd format\n");
+  return -1;
+}
+
+
+/**
+ * Main entry point for the compress command.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return Exit status (0 on success, 1 on error, 130 on interrupt).
+ */
+static int compress_run(int argc, char **argv) {
+  compress_args_t args;
+  build_compress_argtable(&args);
+
+  jbox_setup_sigint_handler();
+
+  int nerrors = arg_parse(argc, argv, args.argtable);
+
+  if (args.help->count > 0) {
+    compress_print_usage(jbox_stdout());
+    cleanup_compress_argtable(&args);
+    return 0;
+  }
+
+  if (nerrors > 0) {
+    arg_print_errors(stderr, args.end, "compress");
+    fprintf(stderr, "Try 'compress --help' for more information.\n");
+    cleanup_compress_argtable(&args);
+    return 1;
+  }
+
+  compress_opts_t opts = { .format = COMPRESS_GZIP,
+                           .decompress = args.decompress->count > 0 };
+  int status = 0;
+  if (args.format->count > 0) {
+    if (strcmp(args.format->sval[0], "gzip") == 0) {
+      opts.format = COMPRESS_GZIP;
+    } else if (strcmp(args.format->sval[0], "zstd") == 0) {
+      opts.format = COMPRESS_ZSTD;
+    } else {
+      fprintf(stderr, "compress: unknown format '%s'\n",
+              args.format->sval[0]);
+      status = 1;
+    }
+  }
+  opts.level = opts.format == COMPRESS_GZIP ? 6 : 3;
+  if (args.level->count > 0) {
+    int max = opts.format == COMPRESS_GZIP ? 9 : ZSTD_maxCLevel();
+    opts.level = args.level->ival[0];
+    if (opts.level < 1 || opts.level > max) {
+      fprintf(stderr, "compress: --level must be from 1 to %d\n", max);
+      status = 1;
+    }
+  }
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int workers = cores > 0 ? (int)cores : 1;
+  if (args.threads->count > 0) {
+    workers = args.threads->ival[0];
+    if (workers < 1) {
+      fprintf(stderr, "compress: --threads must be at least 1\n");
+      status = 1;
+    }
+  }
+  if (workers > COMPRESS_MAX_WORKERS) workers = COMPRESS_MAX_WORKERS;
+  if (status != 0) {
+    fprintf(stderr, "Try 'compress --help' for more information.\n");
+    cleanup_compress_argtable(&args);
+    return status;
+  }
+
+  compress_input_t in = { .fd = jbox_stdin_fd() };
+  const char *in_name = args.file->count > 0 ? args.file->filename[0] : "-";
+  if (strcmp(in_name, "-") != 0) {
+    in.fd = open(in_name, O_RDONLY | O_CLOEXEC);
+    if (in.fd < 0) {
+      fprintf(stderr, "compress: %s: %s\n", in_name, strerror(errno));
+      cleanup_compress_argtable(&args);
+      return 1;
+    }
+  }
+
+  int out_fd = jbox_stdout_fd();
+  if (args.output->count > 0) {
+    out_fd = open(args.output->filename[0],
+                  O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (out_fd < 0) {
+      fprintf(stderr, "compress: %s: %s\n", args.output->filename[0],
+              strerror(errno));
+      if (in.fd != jbox_stdin_fd()) close(in.fd);
+      cleanup_compress_argtable(&args);
+      return 1;
+    }
+  } else if (!opts.decompress && args.force->count == 0 && isatty(out_fd)) {
+    fprintf(stderr, "compress: compressed data not written to a terminal "
+                    "(use -f to force)\n");
+    if (in.fd != jbox_stdin_fd()) close(in.fd);
+    cleanup_compress_argtable(&args);
+    return 1;
+  }
+  fflush(jbox_stdout());
+
+  int rc = 0;
+  if (opts.decompress) rc = detect_format(&in, &opts.format);
+  if (rc == 0 && !(opts.decompress && in.carry_len == 0)) {
+    rc = run_pipeline(&opts, &in, out_fd, workers);
+  }
+
+  if (out_fd != jbox_stdout_fd() && close(out_fd) != 0 && rc == 0) {
+    fprintf(stderr, "compress: %s: %s\n", args.output->filename[0],
+            strerror(errno));
+    rc = -1;
+  }
+  if (in.fd != jbox_stdin_fd()) close(in.fd);
+  cleanup_compress_argtable(&args);
+
+  if (rc == -2) return 130;   /* 128 + SIGINT(2) */
+  return rc == 0 ? 0 : 1;
+}
+
+
+/**
+ * Command specification for compress command.
+ */
+const jshell_cmd_spec_t cmd_compress_spec = {
+  .name = "compress",
+  .summary = "parallel gzip and zstd compression",
+  .long_help = "Compress standard input (or FILE) to standard output as "
+               "gzip, or zstd with -F zstd, using every core; -d "
+               "decompresses either format. Blocks are compressed "
+               "independently and record their sizes, so the output is "
+               "also decompressed in parallel, and stays readable by gzip "
+               "and zstd.",
+  .type = CMD_EXTERNAL,
+  .run = compress_run,
+  .print_usage = compress_print_usage,
+  .describe_args = compress_describe_args
+};
+
+
+/**
+ * Registers the compress command with the shell command registry.
+ */
+void jshell_register_compress_command(void) {
+  jshell_register_command(&cmd_compress_spec);
+}
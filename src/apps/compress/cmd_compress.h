@@ -0,0 +1,10 @@
+#ifndef CMD_COMPRESS_H
+#define CMD_COMPRESS_H
+
+#include "jshell/jshell_cmd_registry.h"
+
+extern const jshell_cmd_spec_t cmd_compress_spec;
+
+void jshell_register_compress_command(void);
+
+#endif
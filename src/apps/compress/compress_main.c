@@ -0,0 +1,17 @@
+/**
+ * @file compress_main.c
+ * @brief Main entry point for standalone compress command.
+ */
+
+#include "cmd_compress.h"
+
+
+/**
+ * Main entry point for standalone compress binary.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return Exit status from compress_run.
+ */
+int main(int argc, char **argv) {
+  return cmd_compress_spec.run(argc, argv);
+}
@@ -0,0 +1,767 @@
+/**
+ * @file cmd_count.c
+ * @brief Count command implementation for jshell.
+ *
+ * Counts how often each line, or one field of it, occurs: what
+ * `sort | uniq -c | sort -rn | head` computes, in one pass and without
+ * sorting the input. Regular files are mapped and cut at newlines into
+ * ranges that the threads take in turn; each thread counts into its own
+ * open-addressing table, whose keys are copied once into the thread's
+ * arena, so counting takes no locks. The tables are folded together at
+ * the end, and the K most frequent keys are picked with a heap of K
+ * entries rather than by sorting them all.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "argtable3.h"
+#include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_ctx.h"
+#include "utils/jbox_json.h"
+#include "utils/jbox_linereader.h"
+#include "utils/jbox_signals.h"
+
+
+/** Upper bound on counting threads */
+#define COUNT_MAX_WORKERS 16
+
+/** Mapped files are cut into ranges of about this size */
+#define COUNT_RANGE (8 * 1024 * 1024)
+
+/** Size of each arena block; longer keys get a block of their own */
+#define COUNT_ARENA_BLOCK (1024 * 1024)
+
+/** Initial slots of a table; a power of two */
+#define COUNT_TABLE_INITIAL 4096
+
+
+/** One distinct key */
+typedef struct {
+  uint64_t hash;
+  const char *key;          /* In an arena; NULL for an empty slot */
+  size_t len;
+  long long count;
+} count_entry_t;
+
+/** Block of key bytes */
+typedef struct count_block {
+  struct count_block *next;
+  size_t used;
+  size_t cap;
+  char data[];
+} count_block_t;
+
+/** Keys and counts of one thread */
+typedef struct {
+  count_entry_t *slots;
+  size_t cap;               /* Power of two */
+  size_t used;
+  count_block_t *blocks;    /* Newest first */
+  int failed;               /* Out of memory */
+} count_table_t;
+
+/** What to count */
+typedef struct {
+  size_t field;             /* From 1; 0 for the whole line */
+  int tab;                  /* Field separator, or -1 for blank runs */
+} count_key_t;
+
+/** A piece of a mapped file */
+typedef struct {
+  const char *data;
+  size_t len;
+} count_range_t;
+
+/** Ranges shared by the counting threads */
+typedef struct {
+  count_range_t *ranges;
+  size_t count;
+  atomic_size_t next;
+  const count_key_t *key;
+} count_pool_t;
+
+typedef struct {
+  count_pool_t *pool;
+  count_table_t *table;
+  int interrupted;
+} count_worker_t;
+
+
+typedef struct {
+  struct arg_lit *help;
+  struct arg_int *field;
+  struct arg_str *separator;
+  struct arg_int *top;
+  struct arg_lit *json;
+  struct arg_file *files;
+  struct arg_end *end;
+  void *argtable[7];
+} count_args_t;
+
+
+/**
+ * Build the argument table for the count command.
+ * @param args Pointer to count_args_t structure to populate.
+ */
+static void build_count_argtable(count_args_t *args) {
+  args->help      = arg_lit0("h", "help", "display this help and exit");
+  args->field     = arg_int0("f", "field", "N",
+                             "count field N of each line instead of the line");
+  args->separator = arg_str0("t", "field-separator", "SEP",
+                             "separate fields with SEP instead of blanks");
+  args->top       = arg_int0("n", "top", "K",
+                             "print only the K most frequent");
+  args->json      = arg_lit0(NULL, "json", "output in JSON format");
+  args->files     = arg_filen(NULL, NULL, "FILE", 0, 1000,
+                              "files to count (default: standard input)");
+  args->end       = arg_end(20);
+
+  args->argtable[0] = args->help;
+  args->argtable[1] = args->field;
+  args->argtable[2] = args->separator;
+  args->argtable[3] = args->top;
+  args->argtable[4] = args->json;
+  args->argtable[5] = args->files;
+  args->argtable[6] = args->end;
+}
+
+
+/**
+ * Clean up and free the argument table.
+ * @param args Pointer to count_args_t structure to clean up.
+ */
+static void cleanup_count_argtable(count_args_t *args) {
+  arg_freetable(args->argtable,
+                sizeof(args->argtable) / sizeof(args->argtable[0]));
+}
+
+
+/**
+ * Print usage information for the count command.
+ * @param out Output stream to write usage information to.
+ */
+static void count_print_usage(FILE *out) {
+  count_args_t args;
+  build_count_argtable(&args);
+  fprintf(out, "Usage: count");
+  arg_print_syntax(out, args.argtable, "\n");
+  fprintf(out, "Print how often each distinct line (or field) occurs, most "
+               "frequent first.\n\n");
+  fprintf(out, "Options:\n");
+  arg_print_glossary(out, args.argtable, "  %-26s %s\n");
+  cleanup_count_argtable(&args);
+}
+
+
+/**
+ * Passes the count argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void count_describe_args(jshell_argtable_visit_fn visit,
+                                void *userdata) {
+  count_args_t args;
+  build_count_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_count_argtable(&args);
+}
+
+
+/**
+ * Hash a key a word at a time.
+ */
+static uint64_t hash_key(const char *s, size_t len) {
+  uint64_t h = 0x9e3779b97f4a7c15ULL ^ len;
+  while (len >= 8) {
+    uint64_t w;
+    memcpy(&w, s, sizeof(w));
+    h = (h ^ w) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 32;
+    s += 8;
+    len -= 8;
+  }
+  if (len > 0) {
+    uint64_t w = 0;
+    memcpy(&w, s, len);
+    h = (h ^ w) * 0xc4ceb9fe1a85ec53ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+
+/**
+ * Copy a key into a table's arena.
+ * @return The copy, or NULL if out of memory.
+ */
+static const char *arena_copy(count_table_t *table, const char *key,
+                              size_t len) {
+  count_block_t *block = table->blocks;
+  if (!block || block->cap - block->used < len) {
+    size_t cap = len > COUNT_ARENA_BLOCK ? len : COUNT_ARENA_BLOCK;
+    block = malloc(sizeof(*block) + cap);
+    if (!block) return NULL;
+    block->next = table->blocks;
+    block->used = 0;
+    block->cap = cap;
+    table->blocks = block;
+  }
+  char *copy = block->data + block->used;
+  memcpy(copy, key, len);
+  block->used += len;
+  return copy;
+}
+
+
+/**
+ * Double a table's slots.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int table_grow(count_table_t *table) {
+  size_t cap = table->cap ? table->cap * 2 : COUNT_TABLE_INITIAL;
+  count_entry_t *slots = calloc(cap, sizeof(count_entry_t));
+  if (!slots) return -1;
+
+  for (size_t i = 0; i < table->cap; i++) {
+    const count_entry_t *e = &table->slots[i];
+    if (!e->key) continue;
+    size_t j = (size_t)e->hash & (cap - 1);
+    while (slots[j].key) j = (j + 1) & (cap - 1);
+    slots[j] = *e;
+  }
+  free(table->slots);
+  table->slots = slots;
+  table->cap = cap;
+  return 0;
+}
+
+
+/**
+ * Add n occurrences of a key.
+ * @param copy Whether the key must be copied into the arena, rather than
+ *        already living in one that outlives the table.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int table_add(count_table_t *table, const char *key, size_t len,
+                     uint64_t hash, long long n, int copy) {
+  /* Keep at most 3/4 of the slots used so probes stay short */
+  if ((table->used + 1) * 4 > table->cap * 3 && table_grow(table) != 0) {
+    return -1;
+  }
+
+  size_t mask = table->cap - 1;
+  size_t i = (size_t)hash & mask;
+  for (;; i = (i + 1) & mask) {
+    count_entry_t *e = &table->slots[i];
+    if (!e->key) break;
+    if (e->hash == hash && e->len == len && memcmp(e->key, key, len) == 0) {
+      e->count += n;
+      return 0;
+    }
+  }
+
+  /* The empty key still needs a non-NULL pointer to mark its slot */
+  const char *stored = copy ? arena_copy(table, key, len) : key;
+  if (!stored) return -1;
+  if (len == 0) stored = "";
+  table->slots[i] = (count_entry_t){
+    .hash = hash, .key = stored, .len = len, .count = n,
+  };
+  table->used++;
+  return 0;
+}
+
+
+static void table_free(count_table_t *table) {
+  free(table->slots);
+  count_block_t *block = table->blocks;
+  while (block) {
+    count_block_t *next = block->next;
+    free(block);
+    block = next;
+  }
+}
+
+
+static inline int is_blank(char c) {
+  return c == ' ' || c == '\t';
+}
+
+
+/**
+ * Find the part of a line that is counted.
+ * @param key Field settings.
+ * @param line Line, without its newline.
+ * @param len Length of the line.
+ * @param out_len Set to the length of the part.
+ * @return Start of the part; an empty part if the field is missing.
+ */
+static const char *extract_key(const count_key_t *key, const char *line,
+                               size_t len, size_t *out_len) {
+  if (key->field == 0) {
+    *out_len = len;
+    return line;
+  }
+
+  const char *p = line;
+  const char *end = line + len;
+  for (size_t f = 1;; f++) {
+    const char *start;
+    const char *stop;
+    if (key->tab >= 0) {
+      start = p;
+      stop = memchr(p, key->tab, (size_t)(end - p));
+      if (!stop) stop = end;
+    } else {
+      while (p < end && is_blank(*p)) p++;
+      start = p;
+      while (p < end && !is_blank(*p)) p++;
+      stop = p;
+    }
+    if (f == key->field) {
+      *out_len = (size_t)(stop - start);
+      return start;
+    }
+    if (stop == end) break;
+    p = key->tab >= 0 ? stop + 1 : stop;
+  }
+  *out_len = 0;
+  return line;
+}
+
+
+/**
+ * Count a line's key.
+ * @return 0 on success, -1 if out of memory.
+ */
+static inline int count_line(count_table_t *table, const count_key_t *key,
+                             const char *line, size_t len) {
+  size_t key_len;
+  const char *k = extract_key(key, line, len, &key_len);
+  return table_add(table, k, key_len, hash_key(k, key_len), 1, 1);
+}
+
+
+/**
+ * Count every line of a piece of text; the last may lack its newline.
+ * @return 0 on success, -1 if out of memory, -2 on interrupt.
+ */
+static int count_text(count_table_t *table, const count_key_t *key,
+                      const char *data, size_t len) {
+  const char *p = data;
+  const char *end = data + len;
+  size_t lines = 0;
+  while (p < end) {
+    const char *nl = memchr(p, '\n', (size_t)(end - p));
+    const char *stop = nl ? nl : end;
+    if (count_line(table, key, p, (size_t)(stop - p)) != 0) return -1;
+    p = stop + 1;
+    if ((++lines & 0xffff) == 0 && jbox_is_interrupted()) return -2;
+  }
+  return 0;
+}
+
+
+static void *count_worker(void *arg) {
+  count_worker_t *w = arg;
+  count_pool_t *pool = w->pool;
+  for (;;) {
+    size_t i = atomic_fetch_add(&pool->next, 1);
+    if (i >= pool->count) break;
+    int rc = count_text(w->table, pool->key, pool->ranges[i].data,
+                        pool->ranges[i].len);
+    if (rc == -1) w->table->failed = 1;
+    if (rc != 0) {
+      if (rc == -2) w->interrupted = 1;
+      /* Let the other threads run out of ranges too */
+      atomic_store(&pool->next, pool->count);
+      break;
+    }
+  }
+  return NULL;
+}
+
+
+/**
+ * Cut a mapped file into ranges that end at newlines.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int add_ranges(count_range_t **ranges, size_t *count, size_t *cap,
+                      const char *data, size_t len) {
+  size_t start = 0;
+  while (start < len) {
+    size_t end = start + COUNT_RANGE;
+    if (end >= len) {
+      end = len;
+    } else {
+      const char *nl = memchr(data + end, '\n', len - end);
+      end = nl ? (size_t)(nl - data) + 1 : len;
+    }
+    if (*count >= *cap) {
+      size_t new_cap = *cap ? *cap * 2 : 64;
+      count_range_t *grown = realloc(*ranges, new_cap * sizeof(**ranges));
+      if (!grown) return -1;
+      *ranges = grown;
+      *cap = new_cap;
+    }
+    (*ranges)[(*count)++] = (count_range_t){ data + start, end - start };
+    start = end;
+  }
+  return 0;
+}
+
+
+/**
+ * Count a stream line by line on the calling thread.
+ * @return 0 on success, -1 on error (printed), -2 on interrupt.
+ */
+static int count_stream(count_table_t *table, const count_key_t *key,
+                        int fd, const char *name) {
+  jbox_linereader_t reader;
+  if (jbox_linereader_init(&reader, fd) != 0) {
+    fprintf(stderr, "count: out of memory\n");
+    return -1;
+  }
+  int rc = 0;
+  char *line;
+  size_t len;
+  for (;;) {
+    int got = jbox_linereader_next(&reader, &line, &len);
+    if (got != 1) {
+      if (got == -1) fprintf(stderr, "count: %s: %s\n", name, strerror(errno));
+      rc = got;
+      break;
+    }
+    if (count_line(table, key, line, len) != 0) {
+      fprintf(stderr, "count: out of memory\n");
+      rc = -1;
+      break;
+    }
+  }
+  jbox_linereader_free(&reader);
+  return rc;
+}
+
+
+/**
+ * Whether a goes after b in the output: fewer occurrences, or as many
+ * and a later key.
+ */
+static int entry_after(const count_entry_t *a, const count_entry_t *b) {
+  if (a->count != b->count) return a->count < b->count;
+  size_t n = a->len < b->len ? a->len : b->len;
+  int c = memcmp(a->key, b->key, n);
+  if (c != 0) return c > 0;
+  return a->len > b->len;
+}
+
+
+static int compare_entries(const void *a, const void *b) {
+  const count_entry_t *x = a;
+  const count_entry_t *y = b;
+  if (entry_after(x, y)) return 1;
+  if (entry_after(y, x)) return -1;
+  return 0;
+}
+
+
+/**
+ * Restore a heap, whose root is the entry that goes last, below i.
+ */
+static void heap_down(count_entry_t *heap, size_t count, size_t i) {
+  for (;;) {
+    size_t last = i;
+    size_t l = 2 * i + 1;
+    size_t r = l + 1;
+    if (l < count && entry_after(&heap[l], &heap[last])) last = l;
+    if (r < count && entry_after(&heap[r], &heap[last])) last = r;
+    if (last == i) return;
+    count_entry_t tmp = heap[i];
+    heap[i] = heap[last];
+    heap[last] = tmp;
+    i = last;
+  }
+}
+
+
+/**
+ * Pick the entries to print, in order.
+ * @param table Folded table.
+ * @param top Most entries wanted, or 0 for all.
+ * @param out_count Set to the number picked.
+ * @return The entries (to free), or NULL if out of memory.
+ */
+static count_entry_t *pick_entries(const count_table_t *table, size_t top,
+                                   size_t *out_count) {
+  size_t want = top > 0 && top < table->used ? top : table->used;
+  count_entry_t *picked = malloc((want ? want : 1) * sizeof(count_entry_t));
+  if (!picked) return NULL;
+
+  /* Keep the best `want` so far, the worst of them at the root */
+  size_t n = 0;
+  for (size_t i = 0; i < table->cap; i++) {
+    const count_entry_t *e = &table->slots[i];
+    if (!e->key) continue;
+    if (n < want) {
+      picked[n++] = *e;
+      if (n == want) {
+        for (size_t j = want / 2; j-- > 0;) heap_down(picked, want, j);
+      }
+    } else if (want > 0 && entry_after(&picked[0], e)) {
+      picked[0] = *e;
+      heap_down(picked, want, 0);
+    }
+  }
+
+  qsort(picked, n, sizeof(count_entry_t), compare_entries);
+  *out_count = n;
+  return picked;
+}
+
+
+/**
+ * Print the counts.
+ */
+static void print_entries(const count_entry_t *entries, size_t n, int json) {
+  if (json) {
+    jbox_printf("[\n");
+    for (size_t i = 0; i < n; i++) {
+      fputs(i == 0 ? "  {\"key\": " : ",\n  {\"key\": ", jbox_stdout());
+      jbox_json_write_string_n(jbox_stdout(), entries[i].key,
+                               entries[i].len);
+      jbox_printf(", \"count\": %lld}", entries[i].count);
+    }
+    jbox_printf(n > 0 ? "\n]\n" : "]\n");
+    return;
+  }
+  for (size_t i = 0; i < n; i++) {
+    jbox_printf("%7lld ", entries[i].count);
+    fwrite(entries[i].key, 1, entries[i].len, jbox_stdout());
+    putc('\n', jbox_stdout());
+  }
+}
+
+
+/** An input kept mapped until the keys are printed */
+typedef struct {
+  void *map;
+  size_t len;
+} count_map_t;
+
+
+/**
+ * Main entry point for the count command.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return Exit status (0 on success, 1 on error, 130 on interrupt).
+ */
+static int count_run(int argc, char **argv) {
+  count_args_t args;
+  build_count_argtable(&args);
+
+  jbox_setup_sigint_handler();
+
+  int nerrors = arg_parse(argc, argv, args.argtable);
+
+  if (args.help->count > 0) {
+    count_print_usage(jbox_stdout());
+    cleanup_count_argtable(&args);
+    return 0;
+  }
+
+  if (nerrors > 0) {
+    arg_print_errors(stderr, args.end, "count");
+    fprintf(stderr, "Try 'count --help' for more information.\n");
+    cleanup_count_argtable(&args);
+    return 1;
+  }
+
+  count_key_t key = { .field = 0, .tab = -1 };
+  size_t top = 0;
+  int status = 0;
+  if (args.field->count > 0) {
+    if (args.field->ival[0] < 1) {
+      fprintf(stderr, "count: --field must be at least 1\n");
+      status = 1;
+    }
+    key.field = (size_t)args.field->ival[0];
+  }
+  if (args.separator->count > 0) {
+    if (strlen(args.separator->sval[0]) != 1) {
+      fprintf(stderr, "count: the field separator must be one character\n");
+      status = 1;
+    }
+    key.tab = (unsigned char)args.separator->sval[0][0];
+  }
+  if (args.top->count > 0) {
+    if (args.top->ival[0] < 1) {
+      fprintf(stderr, "count: --top must be at least 1\n");
+      status = 1;
+    }
+    top = (size_t)args.top->ival[0];
+  }
+  if (status != 0) {
+    fprintf(stderr, "Try 'count --help' for more information.\n");
+    cleanup_count_argtable(&args);
+    return status;
+  }
+
+  count_table_t tables[COUNT_MAX_WORKERS] = {0};
+  count_map_t *maps = calloc((size_t)args.files->count + 1,
+                             sizeof(count_map_t));
+  count_range_t *ranges = NULL;
+  size_t range_count = 0, range_cap = 0;
+  size_t map_count = 0;
+  int file_errors = 0;
+  int rc = maps ? 0 : -1;
+  if (!maps) fprintf(stderr, "count: out of memory\n");
+
+  /* Map what can be mapped; count the rest here as it is read */
+  int file_count = args.files->count > 0 ? args.files->count : 1;
+  for (int i = 0; i < file_count && rc != -2 && maps; i++) {
+    const char *name = args.files->count > 0 ? args.files->filename[i] : "-";
+    int is_stdin = strcmp(name, "-") == 0;
+    int fd = is_stdin ? STDIN_FILENO : open(name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      fprintf(stderr, "count: %s: %s\n", name, strerror(errno));
+      file_errors = 1;
+      continue;
+    }
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) != 0) st.st_mode = 0;
+    if (S_ISREG(st.st_mode) && st.st_size > 0 &&
+        (!is_stdin || lseek(fd, 0, SEEK_CUR) == 0)) {
+      map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    if (map != MAP_FAILED) {
+      madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+      maps[map_count++] = (count_map_t){ map, (size_t)st.st_size };
+      if (add_ranges(&ranges, &range_count, &range_cap, map,
+                     (size_t)st.st_size) != 0) {
+        fprintf(stderr, "count: out of memory\n");
+        rc = -1;
+      }
+    } else if (S_ISDIR(st.st_mode)) {
+      fprintf(stderr, "count: %s: %s\n", name, strerror(EISDIR));
+      file_errors = 1;
+    } else {
+      int got = count_stream(&tables[0], &key, fd, name);
+      if (got == -1) file_errors = 1;
+      else if (got != 0) rc = got;
+    }
+    if (!is_stdin) close(fd);
+  }
+
+  /* Count the mapped ranges on every core */
+  int worker_count = 0;
+  if (rc == 0 && range_count > 0) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    worker_count = cores > 0 ? (int)cores : 1;
+    if (worker_count > COUNT_MAX_WORKERS) worker_count = COUNT_MAX_WORKERS;
+    if ((size_t)worker_count > range_count) worker_count = (int)range_count;
+
+    count_pool_t pool = { .ranges = ranges, .count = range_count,
+                          .key = &key };
+    atomic_init(&pool.next, 0);
+    count_worker_t workers[COUNT_MAX_WORKERS];
+    pthread_t threads[COUNT_MAX_WORKERS];
+    int started[COUNT_MAX_WORKERS] = {0};
+    for (int i = 0; i < worker_count; i++) {
+      workers[i] = (count_worker_t){ .pool = &pool, .table = &tables[i] };
+    }
+    for (int i = 1; i < worker_count; i++) {
+      started[i] = pthread_create(&threads[i], NULL, count_worker,
+                                  &workers[i]) == 0;
+    }
+    count_worker(&workers[0]);
+    for (int i = 1; i < worker_count; i++) {
+      if (started[i]) pthread_join(threads[i], NULL);
+    }
+    for (int i = 0; i < worker_count; i++) {
+      if (workers[i].interrupted) rc = -2;
+      if (tables[i].failed && rc == 0) {
+        fprintf(stderr, "count: out of memory\n");
+        rc = -1;
+      }
+    }
+  }
+
+  /* Fold the other tables into the first; their keys stay in their
+   * arenas until the end */
+  for (int i = 1; i < worker_count && rc == 0; i++) {
+    for (size_t j = 0; j < tables[i].cap; j++) {
+      const count_entry_t *e = &tables[i].slots[j];
+      if (!e->key) continue;
+      if (table_add(&tables[0], e->key, e->len, e->hash, e->count, 0) != 0) {
+        fprintf(stderr, "count: out of memory\n");
+        rc = -1;
+        break;
+      }
+    }
+  }
+
+  if (rc == 0 || rc == -1) {
+    size_t n = 0;
+    count_entry_t *picked = pick_entries(&tables[0], top, &n);
+    if (picked) {
+      print_entries(picked, n, args.json->count > 0);
+      free(picked);
+    } else {
+      fprintf(stderr, "count: out of memory\n");
+      rc = -1;
+    }
+  }
+  fflush(jbox_stdout());
+
+  for (int i = 0; i < COUNT_MAX_WORKERS; i++) table_free(&tables[i]);
+  for (size_t i = 0; i < map_count; i++) munmap(maps[i].map, maps[i].len);
+  free(maps);
+  free(ranges);
+  cleanup_count_argtable(&args);
+
+  if (rc == -2) return 130;   /* 128 + SIGINT(2) */
+  return rc == 0 && !file_errors ? 0 : 1;
+}
+
+
+/**
+ * Command specification for count command.
+ */
+const jshell_cmd_spec_t cmd_count_spec = {
+  .name = "count",
+  .summary = "count distinct lines or fields",
+  .long_help = "Print how often each distinct line of the FILEs (or "
+               "standard input) occurs, most frequent first, like "
+               "`sort | uniq -c | sort -rn` in one pass without sorting. "
+               "-f counts one field (split by blanks or -t), -n keeps the "
+               "top K. Mapped files are counted on all cores.",
+  .type = CMD_EXTERNAL,
+  .run = count_run,
+  .print_usage = count_print_usage,
+  .describe_args = count_describe_args
+};
+
+
+/**
+ * Registers the count command with the shell command registry.
+ */
+void jshell_register_count_command(void) {
+  jshell_register_command(&cmd_count_spec);
+}
@@ -0,0 +1,10 @@
+#ifndef CMD_COUNT_H
+#define CMD_COUNT_H
+
+#include "jshell/jshell_cmd_registry.h"
+
+extern const jshell_cmd_spec_t cmd_count_spec;
+
+void jshell_register_count_command(void);
+
+#endif
@@ -0,0 +1,17 @@
+/**
+ * @file count_main.c
+ * @brief Main entry point for standalone count command.
+ */
+
+#include "cmd_count.h"
+
+
+/**
+ * Main entry point for standalone count binary.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return Exit status from count_run.
+ */
+int main(int argc, char **argv) {
+  return cmd_count_spec.run(argc, argv);
+}
@@ -8,13 +8,14 @@
 #include <string.h>
 #include <errno.h>
 #include <sys/stat.h>
-#include <dirent.h>
 #include <unistd.h>
 #include <libgen.h>
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_ctx.h"
 #include "utils/jbox_signals.h"
+#include "utils/jbox_copy.h"
 
 
 /**
@@ -24,11 +25,14 @@ typedef struct {
   struct arg_lit *help;
   struct arg_lit *recursive;
   struct arg_lit *force;
+  struct arg_lit *update;
+  struct arg_lit *delete;
+  struct arg_lit *sync;
   struct arg_lit *json;
   struct arg_file *source;
   struct arg_file *dest;
   struct arg_end *end;
-  void *argtable[7];
+  void *argtable[10];
 } cp_args_t;
 
 
@@ -41,6 +45,14 @@ static void build_cp_argtable(cp_args_t *args) {
   args->help      = arg_lit0("h", "help", "display this help and exit");
   args->recursive = arg_lit0("r", "recursive", "copy directories recursively");
   args->force     = arg_lit0("f", "force", "overwrite existing files");
+  args->update    = arg_lit0("u", "update",
+                             "skip files whose size and mtime match, "
+                             "overwrite the rest");
+  args->delete    = arg_lit0(NULL, "delete",
+                             "with -r, remove files DEST has and SOURCE "
+                             "does not");
+  args->sync      = arg_lit0(NULL, "sync",
+                             "make DEST a mirror of SOURCE: -r -u --delete");
   args->json      = arg_lit0(NULL, "json", "output in JSON format");
   args->source    = arg_file1(NULL, NULL, "SOURCE", "source file or directory");
   args->dest      = arg_file1(NULL, NULL, "DEST", "destination path");
@@ -49,10 +61,13 @@ static void build_cp_argtable(cp_args_t *args) {
   args->argtable[0] = args->help;
   args->argtable[1] = args->recursive;
   args->argtable[2] = args->force;
-  args->argtable[3] = args->json;
-  args->argtable[4] = args->source;
-  args->argtable[5] = args->dest;
-  args->argtable[6] = args->end;
+  args->argtable[3] = args->update;
+  args->argtable[4] = args->delete;
+  args->argtable[5] = args->sync;
+  args->argtable[6] = args->json;
+  args->argtable[7] = args->source;
+  args->argtable[8] = args->dest;
+  args->argtable[9] = args->end;
 }
 
 
@@ -84,6 +99,20 @@ static void cp_print_usage(FILE *out) {
 }
 
 
+/**
+ * Passes the cp argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void cp_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  cp_args_t args;
+  build_cp_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_cp_argtable(&args);
+}
+
+
 /**
  * Escapes special characters in a string for JSON output.
  *
@@ -134,94 +163,21 @@ static int is_directory(const char *path) {
 }
 
 
-/**
- * Checks if a file or directory exists at the given path.
- *
- * @param path Path to check.
- * @return Non-zero if path exists, 0 otherwise.
- */
-static int file_exists(const char *path) {
-  struct stat st;
-  return stat(path, &st) == 0;
-}
-
-
-/**
- * Copies a single file from source to destination.
- *
- * @param src   Source file path.
- * @param dest  Destination file path.
- * @param force If non-zero, overwrite existing destination.
- * @return 0 on success, -1 on error, -2 if interrupted.
- */
-static int copy_file(const char *src, const char *dest, int force) {
-  if (!force && file_exists(dest)) {
-    errno = EEXIST;
-    return -1;
-  }
-
-  FILE *src_fp = fopen(src, "rb");
-  if (!src_fp) {
-    return -1;
-  }
-
-  FILE *dest_fp = fopen(dest, "wb");
-  if (!dest_fp) {
-    int saved_errno = errno;
-    fclose(src_fp);
-    errno = saved_errno;
-    return -1;
-  }
-
-  char buffer[8192];
-  size_t bytes_read;
-  int result = 0;
-
-  while ((bytes_read = fread(buffer, 1, sizeof(buffer), src_fp)) > 0) {
-    /* Check for interrupt */
-    if (jbox_is_interrupted()) {
-      fclose(src_fp);
-      fclose(dest_fp);
-      return -2;  /* Signal interruption */
-    }
-
-    if (fwrite(buffer, 1, bytes_read, dest_fp) != bytes_read) {
-      result = -1;
-      break;
-    }
-  }
-
-  if (ferror(src_fp)) {
-    result = -1;
-  }
-
-  struct stat src_stat;
-  if (stat(src, &src_stat) == 0) {
-    fchmod(fileno(dest_fp), src_stat.st_mode & 0777);
-  }
-
-  fclose(src_fp);
-  fclose(dest_fp);
-
-  return result;
-}
-
-
-/* Forward declaration for recursive directory copy */
-static int copy_directory(const char *src, const char *dest, int force);
-
-
 /**
  * Copies a file or directory entry from source to destination.
  *
+ * Under -u a lone file goes through jbox_copy_tree() too, which counts
+ * whether it was copied or skipped.
+ *
  * @param src_path  Source path.
  * @param dest_path Destination path.
  * @param recursive If non-zero, copy directories recursively.
- * @param force     If non-zero, overwrite existing files.
+ * @param flags     JBOX_COPY_* flags.
+ * @param stats     Set to what a tree copy did; left zeroed otherwise.
  * @return 0 on success, -1 on error, -2 if interrupted.
  */
 static int copy_entry(const char *src_path, const char *dest_path,
-                      int recursive, int force) {
+                      int recursive, int flags, jbox_copy_stats_t *stats) {
   struct stat st;
   if (stat(src_path, &st) != 0) {
     return -1;
@@ -232,89 +188,12 @@ static int copy_entry(const char *src_path, const char *dest_path,
       errno = EISDIR;
       return -1;
     }
-    int result = copy_directory(src_path, dest_path, force);
-    if (result == -2) return -2;  /* Propagate interruption */
-    return result;
-  } else {
-    int result = copy_file(src_path, dest_path, force);
-    if (result == -2) return -2;  /* Propagate interruption */
-    return result;
-  }
-}
-
-
-/**
- * Recursively copies a directory and its contents.
- *
- * @param src   Source directory path.
- * @param dest  Destination directory path.
- * @param force If non-zero, overwrite existing files.
- * @return 0 on success, -1 on error, -2 if interrupted.
- */
-static int copy_directory(const char *src, const char *dest, int force) {
-  DIR *dir = opendir(src);
-  if (!dir) {
-    return -1;
-  }
-
-  struct stat src_stat;
-  if (stat(src, &src_stat) != 0) {
-    closedir(dir);
-    return -1;
-  }
-
-  if (mkdir(dest, src_stat.st_mode & 0777) != 0 && errno != EEXIST) {
-    closedir(dir);
-    return -1;
+    return jbox_copy_tree(src_path, dest_path, flags, stats);
   }
-
-  int result = 0;
-  struct dirent *entry;
-
-  while ((entry = readdir(dir)) != NULL) {
-    /* Check for interrupt */
-    if (jbox_is_interrupted()) {
-      closedir(dir);
-      return -2;  /* Signal interruption */
-    }
-
-    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-      continue;
-    }
-
-    size_t src_len = strlen(src) + strlen(entry->d_name) + 2;
-    size_t dest_len = strlen(dest) + strlen(entry->d_name) + 2;
-
-    char *src_path = malloc(src_len);
-    char *dest_path = malloc(dest_len);
-
-    if (!src_path || !dest_path) {
-      free(src_path);
-      free(dest_path);
-      result = -1;
-      break;
-    }
-
-    snprintf(src_path, src_len, "%s/%s", src, entry->d_name);
-    snprintf(dest_path, dest_len, "%s/%s", dest, entry->d_name);
-
-    int copy_result = copy_entry(src_path, dest_path, 1, force);
-    if (copy_result == -2) {
-      free(src_path);
-      free(dest_path);
-      closedir(dir);
-      return -2;  /* Propagate interruption */
-    }
-    if (copy_result != 0) {
-      result = -1;
-    }
-
-    free(src_path);
-    free(dest_path);
+  if (flags & JBOX_COPY_UPDATE) {
+    return jbox_copy_tree(src_path, dest_path, flags, stats);
   }
-
-  closedir(dir);
-  return result;
+  return jbox_copy_file(src_path, dest_path, flags);
 }
 
 
@@ -369,7 +248,7 @@ static int cp_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    cp_print_usage(stdout);
+    cp_print_usage(jbox_stdout());
     cleanup_cp_argtable(&args);
     return 0;
   }
@@ -383,15 +262,26 @@ static int cp_run(int argc, char **argv) {
 
   const char *source = args.source->filename[0];
   const char *dest = args.dest->filename[0];
-  int recursive = args.recursive->count > 0;
-  int force = args.force->count > 0;
+  int sync = args.sync->count > 0;
+  int recursive = args.recursive->count > 0 || sync;
   int show_json = args.json->count > 0;
+  int flags = 0;
+  if (args.force->count > 0) flags |= JBOX_COPY_FORCE;
+  if (args.update->count > 0 || sync) flags |= JBOX_COPY_UPDATE;
+  if (args.delete->count > 0 || sync) flags |= JBOX_COPY_DELETE;
+
+  if ((flags & JBOX_COPY_DELETE) && !recursive) {
+    fprintf(stderr, "cp: --delete needs -r\n");
+    cleanup_cp_argtable(&args);
+    return 1;
+  }
 
-  char *final_dest = build_dest_path(source, dest);
+  /* A mirror is DEST itself, so running it again updates it in place */
+  char *final_dest = sync ? strdup(dest) : build_dest_path(source, dest);
   if (!final_dest) {
     if (show_json) {
-      printf("{\"status\": \"error\", \"message\": \"memory allocation "
-             "failed\"}\n");
+      jbox_printf("{\"status\": \"error\", \"message\": \"memory allocation "
+                  "failed\"}\n");
     } else {
       fprintf(stderr, "cp: memory allocation failed\n");
     }
@@ -399,7 +289,8 @@ static int cp_run(int argc, char **argv) {
     return 1;
   }
 
-  int result = copy_entry(source, final_dest, recursive, force);
+  jbox_copy_stats_t stats = { 0 };
+  int result = copy_entry(source, final_dest, recursive, flags, &stats);
 
   /* Check for interruption */
   if (result == -2) {
@@ -414,16 +305,21 @@ static int cp_run(int argc, char **argv) {
     escape_json_string(source, escaped_source, sizeof(escaped_source));
     escape_json_string(final_dest, escaped_dest, sizeof(escaped_dest));
 
-    if (result == 0) {
-      printf("{\"status\": \"ok\", \"source\": \"%s\", \"dest\": \"%s\"}\n",
-             escaped_source, escaped_dest);
+    if (result == 0 && (flags & JBOX_COPY_UPDATE)) {
+      jbox_printf("{\"status\": \"ok\", \"source\": \"%s\", "
+                  "\"dest\": \"%s\", \"copied\": %zu, \"skipped\": %zu, "
+                  "\"deleted\": %zu}\n", escaped_source, escaped_dest,
+                  stats.copied, stats.skipped, stats.deleted);
+    } else if (result == 0) {
+      jbox_printf("{\"status\": \"ok\", \"source\": \"%s\", "
+                  "\"dest\": \"%s\"}\n", escaped_source, escaped_dest);
     } else {
       char escaped_error[256];
       escape_json_string(strerror(errno), escaped_error,
                          sizeof(escaped_error));
-      printf("{\"status\": \"error\", \"source\": \"%s\", \"dest\": \"%s\", "
-             "\"message\": \"%s\"}\n",
-             escaped_source, escaped_dest, escaped_error);
+      jbox_printf("{\"status\": \"error\", \"source\": \"%s\", "
+                  "\"dest\": \"%s\", \"message\": \"%s\"}\n",
+                  escaped_source, escaped_dest, escaped_error);
     }
   } else {
     if (result != 0) {
@@ -453,11 +349,19 @@ const jshell_cmd_spec_t cmd_cp_spec = {
   .name = "cp",
   .summary = "copy files and directories",
   .long_help = "Copy SOURCE to DEST, or copy SOURCE into DEST directory. "
-               "With -r, copy directories recursively. "
-               "With -f, overwrite existing destination files.",
+               "With -r, copy directories recursively, with files copied in "
+               "parallel. Data is reflinked where the filesystem allows, "
+               "otherwise copied inside the kernel. "
+               "With -f, overwrite existing destination files. "
+               "With -u, skip files whose size and mtime match and "
+               "overwrite the rest; --delete also removes files the source "
+               "lacks, and --sync makes DEST a mirror of SOURCE (-r -u "
+               "--delete), so a tree is re-copied in the time it takes to "
+               "compare it.",
   .type = CMD_EXTERNAL,
   .run = cp_run,
-  .print_usage = cp_print_usage
+  .print_usage = cp_print_usage,
+  .describe_args = cp_describe_args
 };
 
 
@@ -0,0 +1,651 @@
+/**
+ * @file cmd_cut.c
+ * @brief Cut command implementation for jshell.
+ *
+ * Selects fields of delimited lines, or of quoted CSV records. Input is
+ * read through one reusable buffer and each record is cut where it lies:
+ * a field is a (pointer, length) view, and the selected ones are copied
+ * straight into an output buffer, so nothing is allocated per line and
+ * memory is bounded by the longest record. The bytes that end a field
+ * (the delimiter, newline and, for CSV, the quote) are found eight at a
+ * time with the exact zero-byte test used for newline counting, and the
+ * scan stops at the newline once the last wanted field has been passed.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "argtable3.h"
+#include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_ctx.h"
+#include "utils/jbox_linereader.h"
+#include "utils/jbox_signals.h"
+
+
+/** Output is written once this much has been cut */
+#define CUT_FLUSH (64 * 1024)
+
+/** Eight copies of a byte value */
+#define BYTES8(b) (0x0101010101010101ULL * (uint64_t)(b))
+
+
+/** Fields lo to hi, from 1; hi is SIZE_MAX for an open range */
+typedef struct {
+  size_t lo;
+  size_t hi;
+} cut_range_t;
+
+/** What to cut and how to print it */
+typedef struct {
+  cut_range_t *ranges;      /* Sorted and disjoint */
+  size_t range_count;
+  size_t last;              /* Highest field wanted */
+  unsigned char delim;
+  const char *out_delim;
+  size_t out_delim_len;
+  int csv;
+  int only_delimited;
+  int json;
+} cut_opts_t;
+
+/** Output cut so far, written in large pieces */
+typedef struct {
+  char *buf;
+  size_t len;
+  size_t cap;
+  int failed;               /* Out of memory */
+} cut_out_t;
+
+
+typedef struct {
+  struct arg_lit *help;
+  struct arg_str *fields;
+  struct arg_str *delimiter;
+  struct arg_lit *csv;
+  struct arg_lit *only_delimited;
+  struct arg_str *output_delimiter;
+  struct arg_lit *json_stream;
+  struct arg_file *files;
+  struct arg_end *end;
+  void *argtable[9];
+} cut_args_t;
+
+
+/**
+ * Build the argument table for the cut command.
+ * @param args Pointer to cut_args_t structure to populate.
+ */
+static void build_cut_argtable(cut_args_t *args) {
+  args->help             = arg_lit0("h", "help",
+                                    "display this help and exit");
+  args->fields           = arg_str0("f", "fields", "LIST",
+                                    "select these fields, e.g. 1,3-5,7-");
+  args->delimiter        = arg_str0("d", "delimiter", "DELIM",
+                                    "split fields at DELIM instead of TAB");
+  args->csv              = arg_lit0(NULL, "csv",
+                                    "parse quoted CSV fields (delimiter ',')");
+  args->only_delimited   = arg_lit0("s", "only-delimited",
+                                    "skip lines without a delimiter");
+  args->output_delimiter = arg_str0(NULL, "output-delimiter", "STRING",
+                                    "join fields with STRING");
+  args->json_stream      = arg_lit0(NULL, "json-stream",
+                                    "output one JSON array per line (NDJSON)");
+  args->files            = arg_filen(NULL, NULL, "FILE", 0, 1000,
+                                     "files to cut (default: standard input)");
+  args->end              = arg_end(20);
+
+  args->argtable[0] = args->help;
+  args->argtable[1] = args->fields;
+  args->argtable[2] = args->delimiter;
+  args->argtable[3] = args->csv;
+  args->argtable[4] = args->only_delimited;
+  args->argtable[5] = args->output_delimiter;
+  args->argtable[6] = args->json_stream;
+  args->argtable[7] = args->files;
+  args->argtable[8] = args->end;
+}
+
+
+/**
+ * Clean up and free the argument table.
+ * @param args Pointer to cut_args_t structure to clean up.
+ */
+static void cleanup_cut_argtable(cut_args_t *args) {
+  arg_freetable(args->argtable,
+                sizeof(args->argtable) / sizeof(args->argtable[0]));
+}
+
+
+/**
+ * Print usage information for the cut command.
+ * @param out Output stream to write usage information to.
+ */
+static void cut_print_usage(FILE *out) {
+  cut_args_t args;
+  build_cut_argtable(&args);
+  fprintf(out, "Usage: cut");
+  arg_print_syntax(out, args.argtable, "\n");
+  fprintf(out, "Print selected fields of each line of the FILEs.\n\n");
+  fprintf(out, "Options:\n");
+  arg_print_glossary(out, args.argtable, "  %-28s %s\n");
+  fprintf(out, "\nLIST is one or more of N, N-M, N- and -M, separated "
+               "by commas.\n");
+  cleanup_cut_argtable(&args);
+}
+
+
+/**
+ * Passes the cut argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void cut_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  cut_args_t args;
+  build_cut_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_cut_argtable(&args);
+}
+
+
+static int compare_ranges(const void *a, const void *b) {
+  const cut_range_t *x = a;
+  const cut_range_t *y = b;
+  return (x->lo > y->lo) - (x->lo < y->lo);
+}
+
+
+/**
+ * Parse a field number.
+ * @return Pointer after the number, or NULL if there is none.
+ */
+static const char *parse_number(const char *s, size_t *value) {
+  if (*s < '0' || *s > '9') return NULL;
+  size_t v = 0;
+  while (*s >= '0' && *s <= '9') {
+    size_t digit = (size_t)(*s - '0');
+    v = v > (SIZE_MAX - 1 - digit) / 10 ? SIZE_MAX - 1 : v * 10 + digit;
+    s++;
+  }
+  *value = v;
+  return s;
+}
+
+
+/**
+ * Parse a field list into sorted, merged ranges.
+ * @return 0 on success, -1 on error (printed).
+ */
+static int parse_fields(const char *list, cut_opts_t *opts) {
+  size_t max = 1;
+  for (const char *s = list; *s; s++) max += *s == ',';
+  cut_range_t *ranges = malloc(max * sizeof(cut_range_t));
+  if (!ranges) {
+    fprintf(stderr, "cut: out of memory\n");
+    return -1;
+  }
+
+  size_t n = 0;
+  const char *s = list;
+  for (;;) {
+    size_t lo = 1, hi;
+    const char *p = parse_number(s, &lo);
+    if (p && *p == '-') {
+      const char *q = parse_number(p + 1, &hi);
+      if (!q) hi = SIZE_MAX;
+      p = q ? q : p + 1;
+    } else if (p) {
+      hi = lo;
+    } else if (*s == '-') {
+      p = parse_number(s + 1, &hi);
+    }
+    if (!p || (*p != ',' && *p != '\0')) {
+      fprintf(stderr, "cut: invalid field list '%s'\n", list);
+      free(ranges);
+      return -1;
+    }
+    if (lo == 0 || hi == 0) {
+      fprintf(stderr, "cut: fields are numbered from 1\n");
+      free(ranges);
+      return -1;
+    }
+    if (hi < lo) {
+      fprintf(stderr, "cut: invalid decreasing range in '%s'\n", list);
+      free(ranges);
+      return -1;
+    }
+    ranges[n++] = (cut_range_t){ lo, hi };
+    if (*p == '\0') break;
+    s = p + 1;
+  }
+
+  /* Fields print in input order and once each, however they are listed */
+  qsort(ranges, n, sizeof(cut_range_t), compare_ranges);
+  size_t merged = 0;
+  for (size_t i = 0; i < n; i++) {
+    cut_range_t *prev = merged > 0 ? &ranges[merged - 1] : NULL;
+    if (prev && (prev->hi == SIZE_MAX || ranges[i].lo <= prev->hi + 1)) {
+      if (ranges[i].hi > prev->hi) prev->hi = ranges[i].hi;
+    } else {
+      ranges[merged++] = ranges[i];
+    }
+  }
+  opts->ranges = ranges;
+  opts->range_count = merged;
+  opts->last = ranges[merged - 1].hi;
+  return 0;
+}
+
+
+/**
+ * Make room for len more bytes of output.
+ * @return Where to put them, or NULL if out of memory.
+ */
+static char *out_room(cut_out_t *out, size_t len) {
+  if (out->len + len > out->cap) {
+    size_t cap = out->cap ? out->cap : CUT_FLUSH * 2;
+    while (cap < out->len + len) cap *= 2;
+    char *grown = realloc(out->buf, cap);
+    if (!grown) {
+      out->failed = 1;
+      return NULL;
+    }
+    out->buf = grown;
+    out->cap = cap;
+  }
+  char *at = out->buf + out->len;
+  out->len += len;
+  return at;
+}
+
+
+static void out_put(cut_out_t *out, const char *data, size_t len) {
+  char *at = out_room(out, len);
+  if (at) memcpy(at, data, len);
+}
+
+
+/**
+ * Append bytes escaped for a JSON string, as jbox_json_write_escaped()
+ * writes them.
+ */
+static void out_escaped(cut_out_t *out, const char *data, size_t len) {
+  size_t run = 0;
+  for (size_t i = 0; i < len; i++) {
+    unsigned char c = (unsigned char)data[i];
+    if (c >= 0x20 && c != '"' && c != '\\') continue;
+    out_put(out, data + run, i - run);
+    run = i + 1;
+    char esc[8];
+    switch (c) {
+      case '"':  out_put(out, "\\\"", 2); break;
+      case '\\': out_put(out, "\\\\", 2); break;
+      case '\b': out_put(out, "\\b", 2); break;
+      case '\f': out_put(out, "\\f", 2); break;
+      case '\n': out_put(out, "\\n", 2); break;
+      case '\r': out_put(out, "\\r", 2); break;
+      case '\t': out_put(out, "\\t", 2); break;
+      default:
+        snprintf(esc, sizeof(esc), "\\u%04x", c);
+        out_put(out, esc, 6);
+        break;
+    }
+  }
+  out_put(out, data + run, len - run);
+}
+
+
+/**
+ * Write the output cut so far.
+ */
+static void out_flush(cut_out_t *out) {
+  if (out->len > 0) fwrite(out->buf, 1, out->len, jbox_stdout());
+  out->len = 0;
+}
+
+
+/**
+ * Top bit set in each byte of word equal to the byte in pattern; exact,
+ * unlike the borrow-based test, so bits can be scanned from either end.
+ */
+static inline uint64_t bytes_equal(uint64_t word, uint64_t pattern) {
+  const uint64_t low7 = BYTES8(0x7f);
+  uint64_t x = word ^ pattern;
+  return ~(((x & low7) + low7) | x | low7);
+}
+
+
+/**
+ * Find the first byte equal to a, b or c, eight bytes per step.
+ * @return Pointer to it, or end if there is none.
+ */
+static const char *find_any(const char *p, const char *end, unsigned char a,
+                            unsigned char b, unsigned char c) {
+  const uint64_t pa = BYTES8(a), pb = BYTES8(b), pc = BYTES8(c);
+  while (end - p >= 8) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);   /* Byte 0 lowest */
+#endif
+    uint64_t hit = bytes_equal(word, pa) | bytes_equal(word, pb) |
+                   bytes_equal(word, pc);
+    if (hit) return p + (__builtin_ctzll(hit) >> 3);
+    p += 8;
+  }
+  while (p < end) {
+    unsigned char ch = (unsigned char)*p;
+    if (ch == a || ch == b || ch == c) return p;
+    p++;
+  }
+  return end;
+}
+
+
+/**
+ * Find the end of the field at p: the next stop byte or newline outside
+ * quotes. Quoted sections are skipped whole, so a doubled quote inside
+ * one just closes and reopens it.
+ * @return Pointer to the byte that ends the field, or end.
+ */
+static const char *field_end(const cut_opts_t *opts, const char *p,
+                             const char *end, unsigned char stop) {
+  if (!opts->csv) return find_any(p, end, stop, '\n', '\n');
+  for (;;) {
+    p = find_any(p, end, stop, '\n', '"');
+    if (p == end || *p != '"') return p;
+    p = memchr(p + 1, '"', (size_t)(end - p - 1));
+    if (!p) return end;
+    p++;
+  }
+}
+
+
+/**
+ * Append a field to the record being printed.
+ */
+static void emit_field(const cut_opts_t *opts, cut_out_t *out,
+                       const char *data, size_t len, int first) {
+  if (!opts->json) {
+    if (!first) out_put(out, opts->out_delim, opts->out_delim_len);
+    out_put(out, data, len);
+    return;
+  }
+
+  out_put(out, first ? "[\"" : ",\"", 2);
+  if (!opts->csv) {
+    out_escaped(out, data, len);
+  } else {
+    /* Drop the quotes; a doubled quote inside them stands for one */
+    const char *end = data + len;
+    int quoted = 0;
+    while (data < end) {
+      const char *q = memchr(data, '"', (size_t)(end - data));
+      if (!q) q = end;
+      out_escaped(out, data, (size_t)(q - data));
+      if (q == end) break;
+      if (quoted && q + 1 < end && q[1] == '"') {
+        out_escaped(out, q, 1);
+        q++;
+      } else {
+        quoted = !quoted;
+      }
+      data = q + 1;
+    }
+  }
+  out_put(out, "\"", 1);
+}
+
+
+/**
+ * Cut one record and append what it prints.
+ * @param opts What to cut
+ * @param p Start of the record
+ * @param end End of the data read so far
+ * @param at_eof Whether end is the end of the input
+ * @param out Output
+ * @return Pointer after the record, or NULL if it does not end before
+ *         end and more input follows (nothing is appended then)
+ */
+static const char *cut_record(const cut_opts_t *opts, const char *p,
+                              const char *end, int at_eof, cut_out_t *out) {
+  size_t mark = out->len;
+  const char *record = p;
+  size_t field = 1;
+  size_t r = 0;
+  int printed = 0;
+  int delimited = 0;
+  const char *q;
+
+  for (;;) {
+    q = field_end(opts, p, end, opts->delim);
+    if (q == end && !at_eof) {
+      out->len = mark;
+      return NULL;
+    }
+    int last_field = q == end || *q == '\n';
+    delimited |= !last_field;
+
+    while (r < opts->range_count && opts->ranges[r].hi < field) r++;
+    if (r < opts->range_count && opts->ranges[r].lo <= field) {
+      size_t len = (size_t)(q - p);
+      if (last_field && opts->csv && len > 0 && p[len - 1] == '\r') len--;
+      emit_field(opts, out, p, len, !printed);
+      printed = 1;
+    }
+    if (last_field) break;
+
+    p = q + 1;
+    if (field++ == opts->last) {
+      /* Nothing more is wanted; the rest only has to be skipped */
+      q = field_end(opts, p, end, '\n');
+      if (q == end && !at_eof) {
+        out->len = mark;
+        return NULL;
+      }
+      break;
+    }
+  }
+
+  if (!delimited) {
+    /* A line without a delimiter passes through whole, like GNU cut */
+    out->len = mark;
+    if (opts->only_delimited) return q == end ? end : q + 1;
+    size_t len = (size_t)(q - record);
+    if (opts->csv && len > 0 && record[len - 1] == '\r') len--;
+    emit_field(opts, out, record, len, 1);
+    printed = 1;
+  }
+  if (opts->json) {
+    out_put(out, printed ? "]\n" : "[]\n", printed ? 2 : 3);
+  } else {
+    out_put(out, "\n", 1);
+  }
+  return q == end ? end : q + 1;
+}
+
+
+/**
+ * Cut every record of a descriptor.
+ * @return 0 on success, -1 on error (printed), -2 on interrupt.
+ */
+static int cut_fd(const cut_opts_t *opts, int fd, const char *name,
+                  cut_out_t *out) {
+  jbox_linereader_t reader;
+  if (jbox_linereader_init(&reader, fd) != 0) {
+    fprintf(stderr, "cut: out of memory\n");
+    return -1;
+  }
+
+  int rc = 0;
+  for (;;) {
+    const char *end = reader.buf + reader.end;
+    while (reader.start < reader.end) {
+      const char *next = cut_record(opts, reader.buf + reader.start, end,
+                                    reader.eof, out);
+      if (!next) break;
+      reader.start = (size_t)(next - reader.buf);
+    }
+    if (out->failed) {
+      fprintf(stderr, "cut: out of memory\n");
+      rc = -1;
+      break;
+    }
+    if (out->len >= CUT_FLUSH) out_flush(out);
+    if (reader.eof) break;
+    if (jbox_is_interrupted()) {
+      rc = -2;
+      break;
+    }
+
+    ssize_t n = jbox_linereader_fill(&reader);
+    if (n == -2) {
+      rc = -2;
+      break;
+    }
+    if (n < 0) {
+      fprintf(stderr, "cut: %s: %s\n", name, strerror(errno));
+      rc = -1;
+      break;
+    }
+    if (n == 0) reader.eof = 1;
+  }
+
+  jbox_linereader_free(&reader);
+  return rc;
+}
+
+
+/**
+ * Main entry point for the cut command.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return Exit status (0 on success, 1 on error, 130 on interrupt).
+ */
+static int cut_run(int argc, char **argv) {
+  cut_args_t args;
+  build_cut_argtable(&args);
+
+  jbox_setup_sigint_handler();
+
+  int nerrors = arg_parse(argc, argv, args.argtable);
+
+  if (args.help->count > 0) {
+    cut_print_usage(jbox_stdout());
+    cleanup_cut_argtable(&args);
+    return 0;
+  }
+
+  if (nerrors > 0) {
+    arg_print_errors(stderr, args.end, "cut");
+    fprintf(stderr, "Try 'cut --help' for more information.\n");
+    cleanup_cut_argtable(&args);
+    return 1;
+  }
+
+  cut_opts_t opts = {
+    .delim = args.csv->count > 0 ? ',' : '\t',
+    .csv = args.csv->count > 0,
+    .only_delimited = args.only_delimited->count > 0,
+    .json = args.json_stream->count > 0,
+  };
+  int status = 0;
+  if (args.fields->count == 0) {
+    fprintf(stderr, "cut: a list of fields (-f) is required\n");
+    status = 1;
+  } else if (parse_fields(args.fields->sval[0], &opts) != 0) {
+    status = 1;
+  }
+  if (args.delimiter->count > 0) {
+    const char *d = args.delimiter->sval[0];
+    if (strlen(d) != 1 || d[0] == '\n' || (opts.csv && d[0] == '"')) {
+      fprintf(stderr, "cut: the delimiter must be a single character\n");
+      status = 1;
+    }
+    opts.delim = (unsigned char)d[0];
+  }
+  if (status != 0) {
+    fprintf(stderr, "Try 'cut --help' for more information.\n");
+    free(opts.ranges);
+    cleanup_cut_argtable(&args);
+    return status;
+  }
+  char delim_text[1] = { (char)opts.delim };
+  if (args.output_delimiter->count > 0) {
+    opts.out_delim = args.output_delimiter->sval[0];
+    opts.out_delim_len = strlen(opts.out_delim);
+  } else {
+    opts.out_delim = delim_text;
+    opts.out_delim_len = 1;
+  }
+
+  cut_out_t out = {0};
+  int file_errors = 0;
+  int rc = 0;
+  int file_count = args.files->count > 0 ? args.files->count : 1;
+  for (int i = 0; i < file_count && rc == 0; i++) {
+    const char *name = args.files->count > 0 ? args.files->filename[i] : "-";
+    int is_stdin = strcmp(name, "-") == 0;
+    int fd = is_stdin ? jbox_stdin_fd() : open(name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      fprintf(stderr, "cut: %s: %s\n", name, strerror(errno));
+      file_errors = 1;
+      continue;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISDIR(st.st_mode)) {
+      fprintf(stderr, "cut: %s: %s\n", name, strerror(EISDIR));
+      file_errors = 1;
+    } else {
+      posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+      int got = cut_fd(&opts, fd, name, &out);
+      if (got == -1 && !out.failed) file_errors = 1;
+      else if (got != 0) rc = got;
+    }
+    if (!is_stdin) close(fd);
+  }
+  out_flush(&out);
+  fflush(jbox_stdout());
+
+  free(out.buf);
+  free(opts.ranges);
+  cleanup_cut_argtable(&args);
+
+  if (rc == -2) return 130;   /* 128 + SIGINT(2) */
+  return rc == 0 && !file_errors ? 0 : 1;
+}
+
+
+/**
+ * Command specification for cut command.
+ */
+const jshell_cmd_spec_t cmd_cut_spec = {
+  .name = "cut",
+  .summary = "select fields of delimited or CSV lines",
+  .long_help = "Print the fields of each line of the FILEs (or standard "
+               "input) chosen by -f LIST, split at TAB or -d DELIM. "
+               "--csv honours quoted fields, which may hold delimiters and "
+               "newlines; --json-stream prints each line as a JSON array. "
+               "Input is streamed through one buffer without allocating "
+               "per line.",
+  .type = CMD_EXTERNAL,
+  .run = cut_run,
+  .print_usage = cut_print_usage,
+  .describe_args = cut_describe_args
+};
+
+
+/**
+ * Registers the cut command with the shell command registry.
+ */
+void jshell_register_cut_command(void) {
+  jshell_register_command(&cmd_cut_spec);
+}
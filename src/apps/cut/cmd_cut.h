@@ -0,0 +1,10 @@
+#ifndef CMD_CUT_H
+#define CMD_CUT_H
+
+#include "jshell/jshell_cmd_registry.h"
+
+extern const jshell_cmd_spec_t cmd_cut_spec;
+
+void jshell_register_cut_command(void);
+
+#endif
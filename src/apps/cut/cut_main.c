@@ -0,0 +1,17 @@
+/**
+ * @file cut_main.c
+ * @brief Main entry point for standalone cut command.
+ */
+
+#include "cmd_cut.h"
+
+
+/**
+ * Main entry point for standalone cut binary.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return Exit status from cut_run.
+ */
+int main(int argc, char **argv) {
+  return cmd_cut_spec.run(argc, argv);
+}
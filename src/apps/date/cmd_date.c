@@ -9,6 +9,7 @@
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_ctx.h"
 
 
 /**
@@ -63,6 +64,20 @@ static void date_print_usage(FILE *out) {
 }
 
 
+/**
+ * Passes the date argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void date_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  date_args_t args;
+  build_date_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_date_argtable(&args);
+}
+
+
 /**
  * Main entry point for the date command.
  *
@@ -79,7 +94,7 @@ static int date_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    date_print_usage(stdout);
+    date_print_usage(jbox_stdout());
     cleanup_date_argtable(&args);
     return 0;
   }
@@ -99,20 +114,21 @@ static int date_run(int argc, char **argv) {
     return 1;
   }
 
-  struct tm *tm_info = localtime(&now);
-  if (tm_info == NULL) {
+  struct tm tm_info;
+  tzset();
+  if (localtime_r(&now, &tm_info) == NULL) {
     perror("date: cannot convert time");
     return 1;
   }
 
   char buffer[128];
-  if (strftime(buffer, sizeof(buffer), "%a %b %e %H:%M:%S %Z %Y", tm_info)
+  if (strftime(buffer, sizeof(buffer), "%a %b %e %H:%M:%S %Z %Y", &tm_info)
       == 0) {
     fprintf(stderr, "date: cannot format time\n");
     return 1;
   }
 
-  printf("%s\n", buffer);
+  jbox_printf("%s\n", buffer);
   return 0;
 }
 
@@ -126,7 +142,8 @@ const jshell_cmd_spec_t cmd_date_spec = {
   .long_help = "Display the current date and time in the default format.",
   .type = CMD_EXTERNAL,
   .run = date_run,
-  .print_usage = date_print_usage
+  .print_usage = date_print_usage,
+  .describe_args = date_describe_args
 };
 
 
@@ -0,0 +1,949 @@
+/**
+ * @file cmd_diff.c
+ * @brief Diff command implementation for jshell.
+ *
+ * Compares two files line by line and prints the changes in normal,
+ * unified or JSON form. Regular files are mapped. The common prefix and
+ * suffix are stripped by comparing bytes a word at a time, and only the
+ * lines between are hashed into equivalence classes, so the search
+ * compares integers. Lines whose class does not occur in the other file
+ * are marked changed and left out of the search, which cannot change the
+ * result. What remains is diffed with Myers' O(ND) algorithm, splitting
+ * at the middle snake so that it runs in linear space; past a cost limit
+ * the split takes the furthest-reaching diagonal instead, trading a
+ * minimal diff for a bounded running time, as GNU diff does.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "argtable3.h"
+#include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_ctx.h"
+#include "utils/jbox_json.h"
+#include "utils/jbox_linereader.h"
+#include "utils/jbox_signals.h"
+
+
+/** Bytes looked at for a NUL to decide a file is binary */
+#define DIFF_BINARY_PROBE (32 * 1024)
+
+/** Lines hashed ahead of the one being looked up */
+#define DIFF_PREFETCH 16
+
+/** Least number of search rounds before the cost limit applies */
+#define DIFF_MIN_EXPENSIVE 4096
+
+
+/** One input, split into lines */
+typedef struct {
+  const char *name;
+  int is_stdin;
+  struct stat st;
+  const char *data;
+  size_t size;
+  void *map;                /* Mapping of data, or NULL if data was read */
+  size_t *starts;           /* Offset of each line, then size */
+  size_t lines;
+  char *changed;            /* Per line: not part of the common lines */
+} diff_file_t;
+
+/** A run of changed lines: [a0, a1) of the old file, [b0, b1) of the new */
+typedef struct {
+  size_t a0, a1;
+  size_t b0, b1;
+} diff_change_t;
+
+/** Equivalence class of lines */
+typedef struct {
+  const char *line;
+  size_t len;
+  uint32_t count[2];        /* Lines of the old and new file in it */
+} diff_class_t;
+
+/** Hash table slot; id 0 is empty */
+typedef struct {
+  uint64_t hash;
+  uint32_t id;
+} diff_slot_t;
+
+/** State of the Myers search over the lines left after discarding */
+typedef struct {
+  const uint32_t *xv;       /* Classes of the old file's lines */
+  const uint32_t *yv;       /* Classes of the new file's lines */
+  char *xchg;
+  char *ychg;
+  ptrdiff_t *fdiag;         /* Furthest x per diagonal, searching forward */
+  ptrdiff_t *bdiag;         /* ... and backward */
+  ptrdiff_t too_expensive;  /* Rounds before settling for a split */
+} diff_search_t;
+
+
+// ---------------------------------------------------------------------------
+// Input
+// ---------------------------------------------------------------------------
+
+/**
+ * Open and read or map one input.
+ * @return 0 on success, -1 on error (printed), -2 on interrupt.
+ */
+static int load_file(diff_file_t *f, const char *name) {
+  f->name = name;
+  f->is_stdin = strcmp(name, "-") == 0;
+  int fd = f->is_stdin ? jbox_stdin_fd() : open(name, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "diff: %s: %s\n", name, strerror(errno));
+    return -1;
+  }
+  if (fstat(fd, &f->st) != 0) {
+    fprintf(stderr, "diff: %s: %s\n", name, strerror(errno));
+    if (!f->is_stdin) close(fd);
+    return -1;
+  }
+  if (S_ISDIR(f->st.st_mode)) {
+    fprintf(stderr, "diff: %s: %s\n", name, strerror(EISDIR));
+    if (!f->is_stdin) close(fd);
+    return -1;
+  }
+
+  int rc = 0;
+  if (S_ISREG(f->st.st_mode) && f->st.st_size > 0 &&
+      (!f->is_stdin || lseek(fd, 0, SEEK_CUR) == 0)) {
+    void *map = mmap(NULL, (size_t)f->st.st_size, PROT_READ, MAP_PRIVATE,
+                     fd, 0);
+    if (map != MAP_FAILED) {
+      madvise(map, (size_t)f->st.st_size, MADV_SEQUENTIAL);
+      f->map = map;
+      f->data = map;
+      f->size = (size_t)f->st.st_size;
+    }
+  }
+  if (!f->map) {
+    /* Keep all of it: the reader's buffer grows while start stays 0 */
+    jbox_linereader_t reader;
+    if (jbox_linereader_init(&reader, fd) != 0) {
+      fprintf(stderr, "diff: out of memory\n");
+      rc = -1;
+    }
+    while (rc == 0) {
+      ssize_t n = jbox_linereader_fill(&reader);
+      if (n == 0) break;
+      if (n == -2) {
+        rc = -2;
+      } else if (n < 0) {
+        fprintf(stderr, "diff: %s: %s\n", name, strerror(errno));
+        rc = -1;
+      }
+    }
+    if (rc == 0) {
+      f->data = reader.buf;
+      f->size = reader.end;
+    } else if (reader.buf) {
+      jbox_linereader_free(&reader);
+    }
+  }
+  if (!f->is_stdin) close(fd);
+  return rc;
+}
+
+
+/**
+ * Record where each line starts.
+ * @return 0, or -1 if out of memory.
+ */
+static int split_lines(diff_file_t *f) {
+  size_t newlines = jbox_linereader_count(f->data, f->size);
+  f->lines = newlines + (f->size > 0 && f->data[f->size - 1] != '\n');
+  f->starts = malloc((f->lines + 1) * sizeof(size_t));
+  f->changed = calloc(f->lines + 1, 1);
+  if (!f->starts || !f->changed) return -1;
+
+  size_t pos = 0;
+  for (size_t i = 0; i < f->lines; i++) {
+    f->starts[i] = pos;
+    const char *nl = memchr(f->data + pos, '\n', f->size - pos);
+    pos = nl ? (size_t)(nl - f->data) + 1 : f->size;
+  }
+  f->starts[f->lines] = f->size;
+  return 0;
+}
+
+
+static void free_file(diff_file_t *f) {
+  if (f->map) munmap(f->map, f->size);
+  else free((char *)f->data);
+  free(f->starts);
+  free(f->changed);
+}
+
+
+static bool is_binary(const diff_file_t *f) {
+  size_t n = f->size < DIFF_BINARY_PROBE ? f->size : DIFF_BINARY_PROBE;
+  return n > 0 && memchr(f->data, '\0', n) != NULL;
+}
+
+
+// ---------------------------------------------------------------------------
+// Comparison
+// ---------------------------------------------------------------------------
+
+/**
+ * Length of the common prefix of two buffers, compared a word at a time.
+ */
+static size_t common_prefix(const char *a, const char *b, size_t n) {
+  size_t i = 0;
+  while (i + 8 <= n) {
+    uint64_t x, y;
+    memcpy(&x, a + i, sizeof(x));
+    memcpy(&y, b + i, sizeof(y));
+    if (x != y) break;
+    i += 8;
+  }
+  while (i < n && a[i] == b[i]) i++;
+  return i;
+}
+
+
+/**
+ * Length of the common suffix of two buffers, at most n bytes.
+ */
+static size_t common_suffix(const char *a, size_t alen, const char *b,
+                            size_t blen, size_t n) {
+  const char *ae = a + alen, *be = b + blen;
+  size_t i = 0;
+  while (i + 8 <= n) {
+    uint64_t x, y;
+    memcpy(&x, ae - i - 8, sizeof(x));
+    memcpy(&y, be - i - 8, sizeof(y));
+    if (x != y) break;
+    i += 8;
+  }
+  while (i < n && ae[-(ptrdiff_t)i - 1] == be[-(ptrdiff_t)i - 1]) i++;
+  return i;
+}
+
+
+static bool at_line_start(const diff_file_t *f, size_t pos, size_t floor) {
+  return pos == floor || f->data[pos - 1] == '\n';
+}
+
+
+/**
+ * Hash a line a word at a time.
+ */
+static uint64_t hash_line(const char *s, size_t len) {
+  uint64_t h = 0x9e3779b97f4a7c15ULL ^ len;
+  while (len >= 8) {
+    uint64_t w;
+    memcpy(&w, s, sizeof(w));
+    h = (h ^ w) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 32;
+    s += 8;
+    len -= 8;
+  }
+  if (len > 0) {
+    uint64_t w = 0;
+    memcpy(&w, s, len);
+    h = (h ^ w) * 0xc4ceb9fe1a85ec53ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+
+/**
+ * Give each line of [first, first + n) of a file its class, adding
+ * classes to the table as they are met. The lines are hashed in one pass
+ * first so that the table slots can be prefetched ahead of the lookups.
+ */
+static void classify(const diff_file_t *f, size_t first, size_t n, int side,
+                     diff_slot_t *slots, size_t mask, diff_class_t *classes,
+                     uint32_t *nclasses, uint32_t *ids, uint64_t *hashes) {
+  for (size_t i = 0; i < n; i++) {
+    size_t start = f->starts[first + i];
+    hashes[i] = hash_line(f->data + start, f->starts[first + i + 1] - start);
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    if (i + DIFF_PREFETCH < n) {
+      __builtin_prefetch(&slots[(size_t)hashes[i + DIFF_PREFETCH] & mask]);
+    }
+    const char *line = f->data + f->starts[first + i];
+    size_t len = f->starts[first + i + 1] - f->starts[first + i];
+    uint64_t hash = hashes[i];
+    size_t s = (size_t)hash & mask;
+    for (;;) {
+      diff_slot_t *slot = &slots[s];
+      if (slot->id == 0) {
+        uint32_t id = ++*nclasses;
+        *slot = (diff_slot_t){ hash, id };
+        classes[id] = (diff_class_t){ line, len, { 0, 0 } };
+        break;
+      }
+      const diff_class_t *c = &classes[slot->id];
+      if (slot->hash == hash && c->len == len &&
+          memcmp(c->line, line, len) == 0) {
+        break;
+      }
+      s = (s + 1) & mask;
+    }
+    ids[i] = slots[s].id;
+    classes[slots[s].id].count[side]++;
+  }
+}
+
+
+/**
+ * Find where to split [xoff, xlim) x [yoff, ylim): a point on a shortest
+ * edit path found by searching forward and backward at once until the
+ * two meet (the middle snake), or an estimate once the search has gone
+ * on too long.
+ * @return 0, or -2 on interrupt.
+ */
+static int find_split(diff_search_t *s, ptrdiff_t xoff, ptrdiff_t xlim,
+                      ptrdiff_t yoff, ptrdiff_t ylim, ptrdiff_t *xmid,
+                      ptrdiff_t *ymid) {
+  ptrdiff_t *fd = s->fdiag, *bd = s->bdiag;
+  const uint32_t *xv = s->xv, *yv = s->yv;
+  const ptrdiff_t dmin = xoff - ylim, dmax = xlim - yoff;
+  const ptrdiff_t fmid = xoff - yoff, bmid = xlim - ylim;
+  ptrdiff_t fmin = fmid, fmax = fmid, bmin = bmid, bmax = bmid;
+  const bool odd = (fmid - bmid) & 1;
+
+  fd[fmid] = xoff;
+  bd[bmid] = xlim;
+  for (ptrdiff_t c = 1;; c++) {
+    /* Extend each forward diagonal by one edit, then along its snake */
+    if (fmin > dmin) fd[--fmin - 1] = -1;
+    else ++fmin;
+    if (fmax < dmax) fd[++fmax + 1] = -1;
+    else --fmax;
+    for (ptrdiff_t d = fmax; d >= fmin; d -= 2) {
+      ptrdiff_t tlo = fd[d - 1], thi = fd[d + 1];
+      ptrdiff_t x = tlo >= thi ? tlo + 1 : thi;
+      ptrdiff_t y = x - d;
+      while (x < xlim && y < ylim && xv[x] == yv[y]) {
+        x++;
+        y++;
+      }
+      fd[d] = x;
+      if (odd && bmin <= d && d <= bmax && bd[d] <= x) {
+        *xmid = x;
+        *ymid = y;
+        return 0;
+      }
+    }
+
+    /* And each backward one */
+    if (bmin > dmin) bd[--bmin - 1] = PTRDIFF_MAX;
+    else ++bmin;
+    if (bmax < dmax) bd[++bmax + 1] = PTRDIFF_MAX;
+    else --bmax;
+    for (ptrdiff_t d = bmax; d >= bmin; d -= 2) {
+      ptrdiff_t tlo = bd[d - 1], thi = bd[d + 1];
+      ptrdiff_t x = tlo < thi ? tlo : thi - 1;
+      ptrdiff_t y = x - d;
+      while (x > xoff && y > yoff && xv[x - 1] == yv[y - 1]) {
+        x--;
+        y--;
+      }
+      bd[d] = x;
+      if (!odd && fmin <= d && d <= fmax && x <= fd[d]) {
+        *xmid = x;
+        *ymid = y;
+        return 0;
+      }
+    }
+
+    if ((c & 255) == 0 && jbox_is_interrupted()) return -2;
+    if (c < s->too_expensive) continue;
+
+    /* Too costly: split at whichever diagonal got furthest */
+    ptrdiff_t fxybest = -1, fxbest = xoff;
+    for (ptrdiff_t d = fmax; d >= fmin; d -= 2) {
+      ptrdiff_t x = fd[d] < xlim ? fd[d] : xlim;
+      ptrdiff_t y = x - d;
+      if (ylim < y) {
+        x = ylim + d;
+        y = ylim;
+      }
+      if (fxybest < x + y) {
+        fxybest = x + y;
+        fxbest = x;
+      }
+    }
+    ptrdiff_t bxybest = PTRDIFF_MAX, bxbest = xlim;
+    for (ptrdiff_t d = bmax; d >= bmin; d -= 2) {
+      ptrdiff_t x = bd[d] > xoff ? bd[d] : xoff;
+      ptrdiff_t y = x - d;
+      if (y < yoff) {
+        x = yoff + d;
+        y = yoff;
+      }
+      if (x + y < bxybest) {
+        bxybest = x + y;
+        bxbest = x;
+      }
+    }
+    if ((xlim + ylim) - bxybest < fxybest - (xoff + yoff)) {
+      *xmid = fxbest;
+      *ymid = fxybest - fxbest;
+    } else {
+      *xmid = bxbest;
+      *ymid = bxybest - bxbest;
+    }
+    return 0;
+  }
+}
+
+
+/**
+ * Mark the lines of [xoff, xlim) and [yoff, ylim) outside a longest
+ * common subsequence as changed.
+ * @return 0, or -2 on interrupt.
+ */
+static int compare_ranges(diff_search_t *s, ptrdiff_t xoff, ptrdiff_t xlim,
+                          ptrdiff_t yoff, ptrdiff_t ylim) {
+  for (;;) {
+    while (xoff < xlim && yoff < ylim && s->xv[xoff] == s->yv[yoff]) {
+      xoff++;
+      yoff++;
+    }
+    while (xoff < xlim && yoff < ylim &&
+           s->xv[xlim - 1] == s->yv[ylim - 1]) {
+      xlim--;
+      ylim--;
+    }
+    if (xoff == xlim) {
+      memset(s->ychg + yoff, 1, (size_t)(ylim - yoff));
+      return 0;
+    }
+    if (yoff == ylim) {
+      memset(s->xchg + xoff, 1, (size_t)(xlim - xoff));
+      return 0;
+    }
+
+    ptrdiff_t xmid, ymid;
+    int rc = find_split(s, xoff, xlim, yoff, ylim, &xmid, &ymid);
+    if (rc == 0) rc = compare_ranges(s, xoff, xmid, yoff, ymid);
+    if (rc != 0) return rc;
+    xoff = xmid;
+    yoff = ymid;
+  }
+}
+
+
+/**
+ * Mark the changed lines of both files.
+ * @return 0, -1 if out of memory, -2 on interrupt.
+ */
+static int compare_files(diff_file_t *a, diff_file_t *b) {
+  /* Strip the lines both files start and end with */
+  size_t common = a->size < b->size ? a->size : b->size;
+  size_t pre = common_prefix(a->data, b->data, common);
+  while (pre > 0 && a->data[pre - 1] != '\n') pre--;
+  size_t suf = common_suffix(a->data, a->size, b->data, b->size,
+                             common - pre);
+  while (suf > 0 && !(at_line_start(a, a->size - suf, pre) &&
+                      at_line_start(b, b->size - suf, pre))) {
+    suf--;
+  }
+  size_t first = jbox_linereader_count(a->data, pre);
+  size_t tail = suf == 0 ? 0 :
+                jbox_linereader_count(a->data + a->size - suf, suf) +
+                (a->data[a->size - 1] != '\n');
+  size_t n = a->lines - first - tail;
+  size_t m = b->lines - first - tail;
+  if (n == 0 || m == 0) {
+    memset(a->changed + first, 1, n);
+    memset(b->changed + first, 1, m);
+    return 0;
+  }
+
+  /* Classify the lines between */
+  size_t cap = 16;
+  while (cap < 2 * (n + m)) cap *= 2;
+  diff_slot_t *slots = calloc(cap, sizeof(diff_slot_t));
+  diff_class_t *classes = malloc((n + m + 1) * sizeof(diff_class_t));
+  uint32_t *xids = malloc(n * sizeof(uint32_t));
+  uint32_t *yids = malloc(m * sizeof(uint32_t));
+  size_t *xmap = malloc(n * sizeof(size_t));
+  size_t *ymap = malloc(m * sizeof(size_t));
+  ptrdiff_t *diags = malloc(2 * (n + m + 3) * sizeof(ptrdiff_t));
+  char *xchg = calloc(n + 1, 1);
+  char *ychg = calloc(m + 1, 1);
+  uint64_t *hashes = malloc((n > m ? n : m) * sizeof(uint64_t));
+  int rc = -1;
+  if (slots && classes && xids && yids && xmap && ymap && diags && xchg &&
+      ychg && hashes && n + m < UINT32_MAX) {
+    uint32_t nclasses = 0;
+    classify(a, first, n, 0, slots, cap - 1, classes, &nclasses, xids,
+             hashes);
+    classify(b, first, m, 1, slots, cap - 1, classes, &nclasses, yids,
+             hashes);
+
+    /* Lines with no match on the other side are changes; keep the rest */
+    size_t nx = 0, ny = 0;
+    for (size_t i = 0; i < n; i++) {
+      if (classes[xids[i]].count[1] == 0) {
+        a->changed[first + i] = 1;
+      } else {
+        xids[nx] = xids[i];
+        xmap[nx++] = first + i;
+      }
+    }
+    for (size_t j = 0; j < m; j++) {
+      if (classes[yids[j]].count[0] == 0) {
+        b->changed[first + j] = 1;
+      } else {
+        yids[ny] = yids[j];
+        ymap[ny++] = first + j;
+      }
+    }
+
+    diff_search_t s = {
+      .xv = xids, .yv = yids, .xchg = xchg, .ychg = ychg,
+      .fdiag = diags + ny + 1,
+      .bdiag = diags + (n + m + 3) + ny + 1,
+      .too_expensive = 1,
+    };
+    for (size_t d = nx + ny + 3; d != 0; d >>= 2) s.too_expensive <<= 1;
+    if (s.too_expensive < DIFF_MIN_EXPENSIVE) {
+      s.too_expensive = DIFF_MIN_EXPENSIVE;
+    }
+    rc = compare_ranges(&s, 0, (ptrdiff_t)nx, 0, (ptrdiff_t)ny);
+    for (size_t i = 0; i < nx; i++) if (xchg[i]) a->changed[xmap[i]] = 1;
+    for (size_t j = 0; j < ny; j++) if (ychg[j]) b->changed[ymap[j]] = 1;
+  }
+
+  free(slots);
+  free(classes);
+  free(xids);
+  free(yids);
+  free(xmap);
+  free(ymap);
+  free(diags);
+  free(xchg);
+  free(ychg);
+  free(hashes);
+  return rc;
+}
+
+
+/**
+ * Gather the changed lines into runs.
+ * @return The runs (to free; NULL if there are none or out of memory).
+ */
+static diff_change_t *collect_changes(const diff_file_t *a,
+                                      const diff_file_t *b, size_t *count) {
+  diff_change_t *changes = NULL;
+  size_t cap = 0;
+  size_t i = 0, j = 0;
+  *count = 0;
+  while (i < a->lines || j < b->lines) {
+    if (i < a->lines && j < b->lines && !a->changed[i] && !b->changed[j]) {
+      i++;
+      j++;
+      continue;
+    }
+    diff_change_t c = { .a0 = i, .b0 = j };
+    while (i < a->lines && a->changed[i]) i++;
+    while (j < b->lines && b->changed[j]) j++;
+    c.a1 = i;
+    c.b1 = j;
+    if (*count == cap) {
+      cap = cap ? cap * 2 : 64;
+      diff_change_t *grown = realloc(changes, cap * sizeof(diff_change_t));
+      if (!grown) {
+        free(changes);
+        *count = 0;
+        return NULL;
+      }
+      changes = grown;
+    }
+    changes[(*count)++] = c;
+  }
+  return changes;
+}
+
+
+// ---------------------------------------------------------------------------
+// Output
+// ---------------------------------------------------------------------------
+
+/**
+ * Print a line after a prefix, noting a missing final newline.
+ */
+static void print_line(FILE *out, const char *prefix, const diff_file_t *f,
+                       size_t i) {
+  size_t start = f->starts[i], end = f->starts[i + 1];
+  fputs(prefix, out);
+  fwrite(f->data + start, 1, end - start, out);
+  if (end == start || f->data[end - 1] != '\n') {
+    fputs("\n\\ No newline at end of file\n", out);
+  }
+}
+
+
+/**
+ * Print a range of lines as normal diff numbers them: "N" or "N,M".
+ */
+static void print_normal_range(FILE *out, size_t from, size_t to) {
+  if (to <= from + 1) fprintf(out, "%zu", to > from ? to : from);
+  else fprintf(out, "%zu,%zu", from + 1, to);
+}
+
+
+static void print_normal(const diff_file_t *a, const diff_file_t *b,
+                         const diff_change_t *changes, size_t count) {
+  FILE *out = jbox_stdout();
+  for (size_t k = 0; k < count; k++) {
+    const diff_change_t *c = &changes[k];
+    char op = c->a0 == c->a1 ? 'a' : c->b0 == c->b1 ? 'd' : 'c';
+    print_normal_range(out, c->a0, c->a1);
+    putc(op, out);
+    print_normal_range(out, c->b0, c->b1);
+    putc('\n', out);
+    for (size_t i = c->a0; i < c->a1; i++) print_line(out, "< ", a, i);
+    if (op == 'c') fputs("---\n", out);
+    for (size_t j = c->b0; j < c->b1; j++) print_line(out, "> ", b, j);
+  }
+}
+
+
+/**
+ * Print a hunk range as unified diff numbers it: "N", "N,COUNT", or the
+ * line before and 0 when empty.
+ */
+static void print_unified_range(FILE *out, size_t from, size_t to) {
+  if (to == from) fprintf(out, "%zu,0", from);
+  else if (to == from + 1) fprintf(out, "%zu", from + 1);
+  else fprintf(out, "%zu,%zu", from + 1, to - from);
+}
+
+
+static void print_header(FILE *out, const char *mark, const diff_file_t *f) {
+  struct timespec ts = f->st.st_mtim;
+  if (f->is_stdin && !S_ISREG(f->st.st_mode)) {
+    clock_gettime(CLOCK_REALTIME, &ts);
+  }
+  struct tm tm;
+  char when[64] = "";
+  if (localtime_r(&ts.tv_sec, &tm)) {
+    char date[32], zone[8];
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+    strftime(zone, sizeof(zone), "%z", &tm);
+    snprintf(when, sizeof(when), "%s.%09ld %s", date, ts.tv_nsec, zone);
+  }
+  fprintf(out, "%s %s\t%s\n", mark, f->name, when);
+}
+
+
+/**
+ * Extent of the hunk starting at changes[first]: the changes no more than
+ * 2 * context lines apart, with context lines around them.
+ * @return Index after the hunk's last change.
+ */
+static size_t hunk_extent(const diff_file_t *a, const diff_change_t *changes,
+                          size_t count, size_t first, size_t context,
+                          diff_change_t *hunk) {
+  size_t last = first;
+  while (last + 1 < count &&
+         changes[last + 1].a0 - changes[last].a1 <= 2 * context) {
+    last++;
+  }
+  const diff_change_t *f = &changes[first], *l = &changes[last];
+  hunk->a0 = f->a0 > context ? f->a0 - context : 0;
+  hunk->a1 = l->a1 + context < a->lines ? l->a1 + context : a->lines;
+  hunk->b0 = f->b0 - (f->a0 - hunk->a0);
+  hunk->b1 = l->b1 + (hunk->a1 - l->a1);
+  return last + 1;
+}
+
+
+static void print_unified(const diff_file_t *a, const diff_file_t *b,
+                          const diff_change_t *changes, size_t count,
+                          size_t context) {
+  FILE *out = jbox_stdout();
+  print_header(out, "---", a);
+  print_header(out, "+++", b);
+  for (size_t k = 0; k < count;) {
+    diff_change_t hunk;
+    size_t next = hunk_extent(a, changes, count, k, context, &hunk);
+    fputs("@@ -", out);
+    print_unified_range(out, hunk.a0, hunk.a1);
+    fputs(" +", out);
+    print_unified_range(out, hunk.b0, hunk.b1);
+    fputs(" @@\n", out);
+
+    size_t pos = hunk.a0;
+    for (; k < next; k++) {
+      const diff_change_t *c = &changes[k];
+      for (; pos < c->a0; pos++) print_line(out, " ", a, pos);
+      for (size_t i = c->a0; i < c->a1; i++) print_line(out, "-", a, i);
+      for (size_t j = c->b0; j < c->b1; j++) print_line(out, "+", b, j);
+      pos = c->a1;
+    }
+    for (; pos < hunk.a1; pos++) print_line(out, " ", a, pos);
+  }
+}
+
+
+/**
+ * Write a line as a JSON string of its prefix and text, without the
+ * newline; a missing final newline becomes a line of its own.
+ */
+static void json_line(FILE *out, char prefix, const diff_file_t *f,
+                      size_t i, bool *first) {
+  size_t start = f->starts[i], end = f->starts[i + 1];
+  bool newline = end > start && f->data[end - 1] == '\n';
+  fputs(*first ? "\"" : ", \"", out);
+  *first = false;
+  putc(prefix, out);
+  jbox_json_write_escaped(out, f->data + start, end - start - newline);
+  putc('"', out);
+  if (!newline) fputs(", \"\\\\ No newline at end of file\"", out);
+}
+
+
+static void print_json(const diff_file_t *a, const diff_file_t *b,
+                       const diff_change_t *changes, size_t count,
+                       size_t context) {
+  FILE *out = jbox_stdout();
+  fputs("{\"old\": ", out);
+  jbox_json_write_string(out, a->name);
+  fputs(", \"new\": ", out);
+  jbox_json_write_string(out, b->name);
+  fputs(", \"hunks\": [", out);
+  for (size_t k = 0; k < count;) {
+    diff_change_t hunk;
+    size_t next = hunk_extent(a, changes, count, k, context, &hunk);
+    fprintf(out, "%s\n  {\"old_start\": %zu, \"old_lines\": %zu, "
+                 "\"new_start\": %zu, \"new_lines\": %zu, \"lines\": [",
+            k == 0 ? "" : ",",
+            hunk.a1 > hunk.a0 ? hunk.a0 + 1 : hunk.a0, hunk.a1 - hunk.a0,
+            hunk.b1 > hunk.b0 ? hunk.b0 + 1 : hunk.b0, hunk.b1 - hunk.b0);
+
+    bool first = true;
+    size_t pos = hunk.a0;
+    for (; k < next; k++) {
+      const diff_change_t *c = &changes[k];
+      for (; pos < c->a0; pos++) json_line(out, ' ', a, pos, &first);
+      for (size_t i = c->a0; i < c->a1; i++) json_line(out, '-', a, i, &first);
+      for (size_t j = c->b0; j < c->b1; j++) json_line(out, '+', b, j, &first);
+      pos = c->a1;
+    }
+    for (; pos < hunk.a1; pos++) json_line(out, ' ', a, pos, &first);
+    fputs("]}", out);
+  }
+  fputs(count > 0 ? "\n]}\n" : "]}\n", out);
+}
+
+
+// ---------------------------------------------------------------------------
+// Command
+// ---------------------------------------------------------------------------
+
+typedef struct {
+  struct arg_lit *help;
+  struct arg_lit *unified;
+  struct arg_int *context;
+  struct arg_lit *brief;
+  struct arg_lit *text;
+  struct arg_lit *json;
+  struct arg_file *files;
+  struct arg_end *end;
+  void *argtable[8];
+} diff_args_t;
+
+
+/**
+ * Build the argument table for the diff command.
+ * @param args Pointer to diff_args_t structure to populate.
+ */
+static void build_diff_argtable(diff_args_t *args) {
+  args->help    = arg_lit0("h", "help", "display this help and exit");
+  args->unified = arg_lit0("u", NULL, "output 3 lines of unified context");
+  args->context = arg_int0("U", "unified", "N",
+                           "output N lines of unified context");
+  args->brief   = arg_lit0("q", "brief", "report only whether files differ");
+  args->text    = arg_lit0("a", "text", "compare binary files as text");
+  args->json    = arg_lit0(NULL, "json", "output hunks in JSON format");
+  args->files   = arg_filen(NULL, NULL, "FILE", 2, 2,
+                            "old and new file ('-' for standard input)");
+  args->end     = arg_end(20);
+
+  args->argtable[0] = args->help;
+  args->argtable[1] = args->unified;
+  args->argtable[2] = args->context;
+  args->argtable[3] = args->brief;
+  args->argtable[4] = args->text;
+  args->argtable[5] = args->json;
+  args->argtable[6] = args->files;
+  args->argtable[7] = args->end;
+}
+
+
+/**
+ * Clean up and free the argument table.
+ * @param args Pointer to diff_args_t structure to clean up.
+ */
+static void cleanup_diff_argtable(diff_args_t *args) {
+  arg_freetable(args->argtable,
+                sizeof(args->argtable) / sizeof(args->argtable[0]));
+}
+
+
+/**
+ * Print usage information for the diff command.
+ * @param out Output stream to write usage information to.
+ */
+static void diff_print_usage(FILE *out) {
+  diff_args_t args;
+  build_diff_argtable(&args);
+  fprintf(out, "Usage: diff");
+  arg_print_syntax(out, args.argtable, "\n");
+  fprintf(out, "Compare two files line by line.\n\n");
+  fprintf(out, "Options:\n");
+  arg_print_glossary(out, args.argtable, "  %-24s %s\n");
+  fprintf(out, "\nExit status is 0 if the files are the same, 1 if they "
+               "differ, 2 on trouble.\n");
+  cleanup_diff_argtable(&args);
+}
+
+
+/**
+ * Passes the diff argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void diff_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  diff_args_t args;
+  build_diff_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_diff_argtable(&args);
+}
+
+
+/**
+ * Main entry point for the diff command.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return Exit status (0 if the same, 1 if different, 2 on error, 130 on
+ *         interrupt).
+ */
+static int diff_run(int argc, char **argv) {
+  diff_args_t args;
+  build_diff_argtable(&args);
+
+  jbox_setup_sigint_handler();
+
+  int nerrors = arg_parse(argc, argv, args.argtable);
+
+  if (args.help->count > 0) {
+    diff_print_usage(jbox_stdout());
+    cleanup_diff_argtable(&args);
+    return 0;
+  }
+
+  if (nerrors > 0) {
+    arg_print_errors(stderr, args.end, "diff");
+    fprintf(stderr, "Try 'diff --help' for more information.\n");
+    cleanup_diff_argtable(&args);
+    return 2;
+  }
+
+  size_t context = 3;
+  if (args.context->count > 0) {
+    if (args.context->ival[0] < 0) {
+      fprintf(stderr, "diff: invalid context length '%d'\n",
+              args.context->ival[0]);
+      fprintf(stderr, "Try 'diff --help' for more information.\n");
+      cleanup_diff_argtable(&args);
+      return 2;
+    }
+    context = (size_t)args.context->ival[0];
+  }
+  bool unified = args.unified->count > 0 || args.context->count > 0;
+
+  diff_file_t files[2] = {0};
+  int rc = load_file(&files[0], args.files->filename[0]);
+  if (rc == 0) rc = load_file(&files[1], args.files->filename[1]);
+  diff_file_t *a = &files[0], *b = &files[1];
+
+  bool same = rc == 0 && a->size == b->size &&
+              common_prefix(a->data, b->data, a->size) == a->size;
+  bool binary = rc == 0 && !same && args.text->count == 0 &&
+                (is_binary(a) || is_binary(b));
+  if (rc == 0 && !same && (args.brief->count > 0 || binary)) {
+    jbox_printf("%s %s and %s differ\n", binary ? "Binary files" : "Files",
+                a->name, b->name);
+  } else if (rc == 0 && (!same || args.json->count > 0)) {
+    if (split_lines(a) != 0 || split_lines(b) != 0) rc = -1;
+    else rc = compare_files(a, b);
+    if (rc == -1) fprintf(stderr, "diff: out of memory\n");
+
+    size_t count = 0;
+    diff_change_t *changes = rc == 0 ? collect_changes(a, b, &count) : NULL;
+    if (rc == 0 && !changes && !same) {
+      fprintf(stderr, "diff: out of memory\n");
+      rc = -1;
+    } else if (rc == 0) {
+      if (args.json->count > 0) print_json(a, b, changes, count, context);
+      else if (unified) print_unified(a, b, changes, count, context);
+      else print_normal(a, b, changes, count);
+    }
+    free(changes);
+  }
+  fflush(jbox_stdout());
+
+  free_file(&files[0]);
+  free_file(&files[1]);
+  cleanup_diff_argtable(&args);
+
+  if (rc == -2) return 130;   /* 128 + SIGINT(2) */
+  if (rc != 0) return 2;
+  return same ? 0 : 1;
+}
+
+
+/**
+ * Command specification for diff command.
+ */
+const jshell_cmd_spec_t cmd_diff_spec = {
+  .name = "diff",
+  .summary = "compare files line by line",
+  .long_help = "Compare two files line by line and print the changes, in "
+               "normal form, as a unified diff (-u, -U N), or as JSON hunks "
+               "(--json). Lines are hashed once, the common start and end "
+               "are stripped first, and the rest is diffed with Myers' "
+               "algorithm in linear space. Exit status is 0 if the files "
+               "are the same, 1 if they differ and 2 on trouble.",
+  .type = CMD_EXTERNAL,
+  .run = diff_run,
+  .print_usage = diff_print_usage,
+  .describe_args = diff_describe_args
+};
+
+
+/**
+ * Registers the diff command with the shell command registry.
+ */
+void jshell_register_diff_command(void) {
+  jshell_register_command(&cmd_diff_spec);
+}
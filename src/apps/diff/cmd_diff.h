@@ -0,0 +1,10 @@
+#ifndef CMD_DIFF_H
+#define CMD_DIFF_H
+
+#include "jshell/jshell_cmd_registry.h"
+
+extern const jshell_cmd_spec_t cmd_diff_spec;
+
+void jshell_register_diff_command(void);
+
+#endif
@@ -0,0 +1,17 @@
+/**
+ * @file diff_main.c
+ * @brief Main entry point for standalone diff command.
+ */
+
+#include "cmd_diff.h"
+
+
+/**
+ * Main entry point for standalone diff binary.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return Exit status from diff_run.
+ */
+int main(int argc, char **argv) {
+  return cmd_diff_spec.run(argc, argv);
+}
@@ -0,0 +1,122 @@
+# Shared package building rules for jshell apps
+# Include this in each app's Makefile after defining:
+#   PKG_BIN     - path to built binary (required)
+#
+# Optional overrides:
+#   PKG_NAME     - package name (defaults to current directory name)
+#   PKG_VERSION  - version string (read from pkg.json if not set)
+#   PKG_PLATFORM - platform tag of the prebuilt package (this machine's
+#                  "<os>-<machine>[-<libc>]" if not set, as pkg computes it)
+
+PROJECT_ROOT ?= ../../..
+PKG_REPO_DIR := $(PROJECT_ROOT)/srv/pkg_repository/downloads
+PKG_NAME ?= $(notdir $(CURDIR))
+PKG_JSON := pkg.json
+PKG_STAGING := .pkg-staging
+
+# Dependencies paths (for bundling into package)
+PKG_ARGTABLE_DIR := $(PROJECT_ROOT)/extern/argtable3/dist
+PKG_JSHELL_DIR := $(PROJECT_ROOT)/src/jshell
+PKG_UTILS_DIR := $(PROJECT_ROOT)/src/utils
+
+# Extract version from pkg.json if not provided
+PKG_VERSION ?= $(shell grep -o '"version"[[:space:]]*:[[:space:]]*"[^"]*"' \
+                 $(PKG_JSON) 2>/dev/null | \
+                 sed 's/.*"\([^"]*\)"$$/\1/' || echo "0.0.0")
+
+PKG_TARBALL := $(PKG_NAME)-$(PKG_VERSION).tar.gz
+PKG_DEST := $(PKG_REPO_DIR)/$(PKG_TARBALL)
+
+# Prebuilt packages are tagged with the platform they run on; installs
+# on a matching machine take them instead of compiling the sources
+PKG_OS = $(shell uname -s | tr 'A-Z' 'a-z')
+PKG_LIBC = $(if $(filter linux,$(PKG_OS)),$(shell getconf GNU_LIBC_VERSION \
+             >/dev/null 2>&1 && echo -gnu || echo -musl))
+PKG_PLATFORM ?= $(PKG_OS)-$(shell uname -m | tr 'A-Z' 'a-z')$(PKG_LIBC)
+PKG_BIN_STAGING := .pkg-bin-staging
+PKG_BIN_TARBALL = $(PKG_NAME)-$(PKG_VERSION)-$(PKG_PLATFORM).tar.gz
+PKG_BIN_DEST = $(PKG_REPO_DIR)/$(PKG_BIN_TARBALL)
+
+.PHONY: pkg pkg-bin pkg-clean pkg-info
+
+pkg: $(PKG_BIN) $(PKG_JSON)
+	@echo "Building package $(PKG_NAME)-$(PKG_VERSION)..."
+	@rm -rf $(PKG_STAGING)
+	@mkdir -p $(PKG_STAGING)/bin
+	@mkdir -p $(PKG_STAGING)/deps/jshell
+	@mkdir -p $(PKG_STAGING)/deps/utils
+	@cp $(PKG_BIN) $(PKG_STAGING)/bin/$(PKG_NAME)
+	@cp $(PKG_JSON) $(PKG_STAGING)/
+	@cp Makefile $(PKG_STAGING)/ 2>/dev/null || true
+	@cp pkg.mk $(PKG_STAGING)/ 2>/dev/null || true
+	@cp *.c $(PKG_STAGING)/ 2>/dev/null || true
+	@cp *.h $(PKG_STAGING)/ 2>/dev/null || true
+	@cp *.a $(PKG_STAGING)/ 2>/dev/null || true
+	@# Bundle argtable3 dependencies
+	@cp $(PKG_ARGTABLE_DIR)/argtable3.h $(PKG_STAGING)/deps/
+	@cp $(PKG_ARGTABLE_DIR)/argtable3.c $(PKG_STAGING)/deps/
+	@cp $(PKG_ARGTABLE_DIR)/argtable3.o $(PKG_STAGING)/deps/ 2>/dev/null || true
+	@# Bundle jshell dependencies
+	@cp $(PKG_JSHELL_DIR)/jshell_cmd_registry.h $(PKG_STAGING)/deps/jshell/
+	@cp $(PKG_JSHELL_DIR)/jshell_cmd_registry.c $(PKG_STAGING)/deps/jshell/
+	@# Bundle utils dependencies
+	@cp $(PKG_UTILS_DIR)/jbox_ctx.h $(PKG_STAGING)/deps/utils/
+	@cp $(PKG_UTILS_DIR)/jbox_ctx.c $(PKG_STAGING)/deps/utils/
+	@cp $(PKG_UTILS_DIR)/jbox_signals.h $(PKG_STAGING)/deps/utils/
+	@cp $(PKG_UTILS_DIR)/jbox_signals.c $(PKG_STAGING)/deps/utils/
+	@cp $(PKG_UTILS_DIR)/jbox_json.h $(PKG_STAGING)/deps/utils/
+	@cp $(PKG_UTILS_DIR)/jbox_json.c $(PKG_STAGING)/deps/utils/
+	@cp $(PKG_UTILS_DIR)/jbox_record.h $(PKG_STAGING)/deps/utils/
+	@cp $(PKG_UTILS_DIR)/jbox_record.c $(PKG_STAGING)/deps/utils/
+	@cp $(PKG_UTILS_DIR)/jbox_regex.h $(PKG_STAGING)/deps/utils/
+	@cp $(PKG_UTILS_DIR)/jbox_regex.c $(PKG_STAGING)/deps/utils/
+	@cp $(PKG_UTILS_DIR)/jbox_copy.h $(PKG_STAGING)/deps/utils/
+	@cp $(PKG_UTILS_DIR)/jbox_copy.c $(PKG_STAGING)/deps/utils/
+	@cp $(PKG_UTILS_DIR)/jbox_remove.h $(PKG_STAGING)/deps/utils/
+	@cp $(PKG_UTILS_DIR)/jbox_remove.c $(PKG_STAGING)/deps/utils/
+	@cp $(PKG_UTILS_DIR)/jbox_dircache.h $(PKG_STAGING)/deps/utils/
+	@cp $(PKG_UTILS_DIR)/jbox_dircache.c $(PKG_STAGING)/deps/utils/
+	@cp $(PKG_UTILS_DIR)/jbox_screen.h $(PKG_STAGING)/deps/utils/
+	@cp $(PKG_UTILS_DIR)/jbox_screen.c $(PKG_STAGING)/deps/utils/
+	@cp $(PKG_UTILS_DIR)/jbox_linereader.h $(PKG_STAGING)/deps/utils/
+	@cp $(PKG_UTILS_DIR)/jbox_linereader.c $(PKG_STAGING)/deps/utils/
+	@cp $(PKG_UTILS_DIR)/jbox_aio.h $(PKG_STAGING)/deps/utils/
+	@cp $(PKG_UTILS_DIR)/jbox_aio.c $(PKG_STAGING)/deps/utils/
+	@cp $(PKG_UTILS_DIR)/jbox_walk.h $(PKG_STAGING)/deps/utils/
+	@cp $(PKG_UTILS_DIR)/jbox_walk.c $(PKG_STAGING)/deps/utils/
+	@cp $(PKG_UTILS_DIR)/jbox_hash.h $(PKG_STAGING)/deps/utils/
+	@cp $(PKG_UTILS_DIR)/jbox_hash.c $(PKG_STAGING)/deps/utils/
+	@cp $(PKG_UTILS_DIR)/jbox_gzip.h $(PKG_STAGING)/deps/utils/
+	@cp $(PKG_UTILS_DIR)/jbox_gzip.c $(PKG_STAGING)/deps/utils/
+	@mkdir -p $(PKG_REPO_DIR)
+	@tar -czf $(PKG_DEST) -C $(PKG_STAGING) .
+	@rm -rf $(PKG_STAGING)
+	@echo "  Created: $(PKG_DEST)"
+	@echo "  Bundled deps: argtable3, jshell_cmd_registry, jbox_ctx, jbox_signals, jbox_json, jbox_record, jbox_regex, jbox_copy, jbox_remove, jbox_dircache, jbox_screen, jbox_linereader, jbox_aio, jbox_walk, jbox_hash, jbox_gzip"
+
+# Binary-only package: the built binary and a pkg.json naming its
+# platform, with no Makefile, so installing it runs no compile
+pkg-bin: $(PKG_BIN) $(PKG_JSON)
+	@echo "Building prebuilt package $(PKG_NAME)-$(PKG_VERSION) for $(PKG_PLATFORM)..."
+	@rm -rf $(PKG_BIN_STAGING)
+	@mkdir -p $(PKG_BIN_STAGING)/bin
+	@cp $(PKG_BIN) $(PKG_BIN_STAGING)/bin/$(PKG_NAME)
+	@cp README.md $(PKG_BIN_STAGING)/ 2>/dev/null || true
+	@awk '!done && sub(/\{/, "{\n  \"platform\": \"$(PKG_PLATFORM)\",") { done = 1 } 1' \
+		$(PKG_JSON) > $(PKG_BIN_STAGING)/pkg.json
+	@mkdir -p $(PKG_REPO_DIR)
+	@tar -czf $(PKG_BIN_DEST) -C $(PKG_BIN_STAGING) .
+	@rm -rf $(PKG_BIN_STAGING)
+	@echo "  Created: $(PKG_BIN_DEST)"
+
+pkg-clean:
+	rm -rf $(PKG_STAGING) $(PKG_BIN_STAGING)
+	rm -f $(PKG_DEST) $(PKG_BIN_DEST)
+
+pkg-info:
+	@echo "Package:  $(PKG_NAME)"
+	@echo "Version:  $(PKG_VERSION)"
+	@echo "Binary:   $(PKG_BIN)"
+	@echo "Output:   $(PKG_DEST)"
+	@echo "Platform: $(PKG_PLATFORM)"
+	@echo "Prebuilt: $(PKG_BIN_DEST)"
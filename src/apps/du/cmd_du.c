@@ -0,0 +1,678 @@
+/**
+ * @file cmd_du.c
+ * @brief Du command implementation for jshell.
+ *
+ * Each PATH is walked with jbox_walk() on every core, and each entry is
+ * stat'ed with statx() asking only for what the sum needs. Every
+ * directory gets a record whose total the walker threads add into with
+ * atomics; the walker leaves a directory only after everything below it,
+ * so at that point its total is final and is added to its parent's.
+ * Files with more than one link are counted once, the first time their
+ * inode is seen, through a hash set split into independently locked
+ * shards.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "argtable3.h"
+#include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_ctx.h"
+#include "utils/jbox_json.h"
+#include "utils/jbox_signals.h"
+#include "utils/jbox_walk.h"
+
+
+/** Shards of the hardlink set; a power of two */
+#define DU_INODE_SHARDS 64
+
+/** Output formats */
+enum {
+  DU_OUT_TEXT,
+  DU_OUT_JSON,
+  DU_OUT_STREAM
+};
+
+
+/** What du needs to know of an entry */
+typedef struct {
+  mode_t mode;
+  uint64_t nlink;
+  uint64_t dev;
+  uint64_t ino;
+  long long size;
+  long long blocks;       /* 512-byte units */
+} du_stat_t;
+
+/** Running totals of one directory */
+typedef struct du_dir {
+  struct du_dir *parent;  /* NULL for a PATH */
+  atomic_llong bytes;     /* Itself, its entries and finished subdirectories */
+  atomic_llong files;
+  int depth;
+  char path[];
+} du_dir_t;
+
+/** One inode seen with more than one link; dev is stored plus one so a
+ *  zeroed slot is empty */
+typedef struct {
+  uint64_t dev;
+  uint64_t ino;
+} du_inode_t;
+
+typedef struct {
+  pthread_mutex_t lock;
+  du_inode_t *slots;
+  size_t count;
+  size_t cap;             /* Power of two, or 0 */
+} du_inode_shard_t;
+
+/** A total waiting to be printed */
+typedef struct {
+  char *path;
+  long long bytes;
+  long long files;
+} du_result_t;
+
+/** State shared by the walker threads */
+typedef struct {
+  int apparent;           /* Sum sizes rather than allocated blocks */
+  int max_depth;          /* Deepest totals printed; -1 for all */
+  int format;
+  int in_bytes;           /* Print bytes rather than KiB */
+  du_inode_shard_t shards[DU_INODE_SHARDS];
+  du_result_t *results;   /* Collected unless streaming */
+  size_t count;
+  size_t capacity;
+  int failed;             /* An entry could not be read */
+  int out_of_memory;
+  int first_json;         /* No --json object printed yet */
+  pthread_mutex_t lock;
+} du_state_t;
+
+
+typedef struct {
+  struct arg_lit *help;
+  struct arg_lit *summarize;
+  struct arg_int *max_depth;
+  struct arg_lit *bytes;
+  struct arg_lit *apparent;
+  struct arg_lit *json;
+  struct arg_lit *json_stream;
+  struct arg_file *paths;
+  struct arg_end *end;
+  void *argtable[9];
+} du_args_t;
+
+
+/**
+ * Build the argument table for the du command.
+ * @param args Pointer to du_args_t structure to populate.
+ */
+static void build_du_argtable(du_args_t *args) {
+  args->help        = arg_lit0("h", "help", "display this help and exit");
+  args->summarize   = arg_lit0("s", "summarize",
+                               "print only a total for each PATH");
+  args->max_depth   = arg_int0("d", "max-depth", "N",
+                               "print totals at most N levels below PATH");
+  args->bytes       = arg_lit0("b", "bytes",
+                               "print bytes rather than KiB");
+  args->apparent    = arg_lit0(NULL, "apparent-size",
+                               "sum file sizes rather than disk usage");
+  args->json        = arg_lit0(NULL, "json", "output in JSON format");
+  args->json_stream = arg_lit0(NULL, "json-stream",
+                               "output one JSON object per directory as "
+                               "each is finished (NDJSON)");
+  args->paths       = arg_filen(NULL, NULL, "PATH", 0, 1000,
+                                "what to sum (default: .)");
+  args->end         = arg_end(20);
+
+  args->argtable[0] = args->help;
+  args->argtable[1] = args->summarize;
+  args->argtable[2] = args->max_depth;
+  args->argtable[3] = args->bytes;
+  args->argtable[4] = args->apparent;
+  args->argtable[5] = args->json;
+  args->argtable[6] = args->json_stream;
+  args->argtable[7] = args->paths;
+  args->argtable[8] = args->end;
+}
+
+
+/**
+ * Clean up and free the argument table.
+ * @param args Pointer to du_args_t structure to clean up.
+ */
+static void cleanup_du_argtable(du_args_t *args) {
+  arg_freetable(args->argtable,
+                sizeof(args->argtable) / sizeof(args->argtable[0]));
+}
+
+
+/**
+ * Print usage information for the du command.
+ * @param out Output stream to write usage information to.
+ */
+static void du_print_usage(FILE *out) {
+  du_args_t args;
+  build_du_argtable(&args);
+  fprintf(out, "Usage: du");
+  arg_print_syntax(out, args.argtable, "\n");
+  fprintf(out, "Summarize disk usage of each PATH, directories "
+               "recursively.\n\n");
+  fprintf(out, "Options:\n");
+  arg_print_glossary(out, args.argtable, "  %-24s %s\n");
+  cleanup_du_argtable(&args);
+}
+
+
+/**
+ * Passes the du argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void du_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  du_args_t args;
+  build_du_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_du_argtable(&args);
+}
+
+
+/**
+ * Tells the result cache what the output of du depends on: everything below
+ * the named paths.
+ *
+ * @param argc Number of arguments
+ * @param argv Array of argument strings
+ * @return How this run may be cached
+ */
+static jshell_cmd_cache_t du_cache_scope(int argc, char **argv) {
+  du_args_t args;
+  build_du_argtable(&args);
+  int nerrors = arg_parse(argc, argv, args.argtable);
+  jshell_cmd_cache_t scope = CMD_CACHE_NONE;
+  if (nerrors == 0 && args.help->count == 0) {
+    scope = CMD_CACHE_TREES;
+  }
+  cleanup_du_argtable(&args);
+  return scope;
+}
+
+
+/**
+ * Stat an entry for its size, blocks and inode, through statx() asking
+ * for just those, or fstatat() where statx() is missing.
+ * @param dir_fd Containing directory.
+ * @param name Entry name.
+ * @param follow Follow a final symlink.
+ * @param st Set to the entry's details.
+ * @return 0 on success, -1 on error (errno set).
+ */
+static int du_stat(int dir_fd, const char *name, int follow, du_stat_t *st) {
+  int flags = AT_NO_AUTOMOUNT | AT_STATX_DONT_SYNC;
+  if (!follow) flags |= AT_SYMLINK_NOFOLLOW;
+
+  struct statx sx;
+  if (statx(dir_fd, name, flags,
+            STATX_TYPE | STATX_NLINK | STATX_INO | STATX_SIZE |
+            STATX_BLOCKS, &sx) == 0) {
+    st->mode = sx.stx_mode;
+    st->nlink = sx.stx_nlink;
+    st->dev = makedev(sx.stx_dev_major, sx.stx_dev_minor);
+    st->ino = sx.stx_ino;
+    st->size = (long long)sx.stx_size;
+    st->blocks = (long long)sx.stx_blocks;
+    return 0;
+  }
+  if (errno != ENOSYS) return -1;
+
+  struct stat sb;
+  if (fstatat(dir_fd, name, &sb, follow ? 0 : AT_SYMLINK_NOFOLLOW) != 0) {
+    return -1;
+  }
+  st->mode = sb.st_mode;
+  st->nlink = sb.st_nlink;
+  st->dev = sb.st_dev;
+  st->ino = sb.st_ino;
+  st->size = (long long)sb.st_size;
+  st->blocks = (long long)sb.st_blocks;
+  return 0;
+}
+
+
+/**
+ * Mix a device and inode number into a hash.
+ */
+static uint64_t hash_inode(uint64_t dev, uint64_t ino) {
+  uint64_t h = ino * 0x9e3779b97f4a7c15ULL ^ dev * 0xc2b2ae3d27d4eb4fULL;
+  return h ^ (h >> 29);
+}
+
+
+/**
+ * Insert a slot into a shard whose table has room.
+ */
+static void shard_put(du_inode_shard_t *shard, du_inode_t key, uint64_t h) {
+  size_t mask = shard->cap - 1;
+  size_t i = (size_t)h & mask;
+  while (shard->slots[i].dev != 0) i = (i + 1) & mask;
+  shard->slots[i] = key;
+  shard->count++;
+}
+
+
+/**
+ * Record an inode with more than one link.
+ * @param state Shared state.
+ * @param dev Device number.
+ * @param ino Inode number.
+ * @return 1 if it was not seen before, 0 if it was, -1 if out of memory.
+ */
+static int inode_add(du_state_t *state, uint64_t dev, uint64_t ino) {
+  uint64_t h = hash_inode(dev, ino);
+  du_inode_shard_t *shard = &state->shards[h >> 58 & (DU_INODE_SHARDS - 1)];
+  du_inode_t key = { .dev = dev + 1, .ino = ino };
+
+  pthread_mutex_lock(&shard->lock);
+  if (shard->cap > 0) {
+    size_t mask = shard->cap - 1;
+    for (size_t i = (size_t)h & mask; shard->slots[i].dev != 0;
+         i = (i + 1) & mask) {
+      if (shard->slots[i].dev == key.dev && shard->slots[i].ino == ino) {
+        pthread_mutex_unlock(&shard->lock);
+        return 0;
+      }
+    }
+  }
+
+  /* Grow at 3/4 full so probes stay short */
+  if ((shard->count + 1) * 4 > shard->cap * 3) {
+    size_t new_cap = shard->cap ? shard->cap * 2 : 256;
+    du_inode_t *old = shard->slots;
+    size_t old_cap = shard->cap;
+    shard->slots = calloc(new_cap, sizeof(du_inode_t));
+    if (!shard->slots) {
+      shard->slots = old;
+      pthread_mutex_unlock(&shard->lock);
+      return -1;
+    }
+    shard->cap = new_cap;
+    shard->count = 0;
+    for (size_t i = 0; i < old_cap; i++) {
+      if (old[i].dev != 0) {
+        shard_put(shard, old[i], hash_inode(old[i].dev - 1, old[i].ino));
+      }
+    }
+    free(old);
+  }
+  shard_put(shard, key, h);
+  pthread_mutex_unlock(&shard->lock);
+  return 1;
+}
+
+
+/**
+ * Note a failure under the state lock.
+ * @param state Shared state.
+ * @param oom Whether memory ran out, rather than an entry being unreadable.
+ */
+static void note_failure(du_state_t *state, int oom) {
+  pthread_mutex_lock(&state->lock);
+  if (oom) {
+    state->out_of_memory = 1;
+  } else {
+    state->failed = 1;
+  }
+  pthread_mutex_unlock(&state->lock);
+}
+
+
+/**
+ * Print one total as a JSON object.
+ */
+static void print_json_total(const char *path, long long bytes,
+                             long long files) {
+  fputs("{\"path\": ", jbox_stdout());
+  jbox_json_write_string(jbox_stdout(), path);
+  jbox_printf(", \"bytes\": %lld, \"files\": %lld}", bytes, files);
+}
+
+
+/**
+ * Print a finished total now, or keep it to print sorted at the end.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int emit_total(du_state_t *state, const char *path, long long bytes,
+                      long long files) {
+  if (state->format == DU_OUT_STREAM) {
+    pthread_mutex_lock(&state->lock);
+    print_json_total(path, bytes, files);
+    jbox_printf("\n");
+    fflush(jbox_stdout());
+    pthread_mutex_unlock(&state->lock);
+    return 0;
+  }
+
+  char *copy = strdup(path);
+  if (!copy) return -1;
+  pthread_mutex_lock(&state->lock);
+  if (state->count >= state->capacity) {
+    size_t new_cap = state->capacity ? state->capacity * 2 : 256;
+    du_result_t *grown = realloc(state->results,
+                                 new_cap * sizeof(du_result_t));
+    if (!grown) {
+      pthread_mutex_unlock(&state->lock);
+      free(copy);
+      return -1;
+    }
+    state->results = grown;
+    state->capacity = new_cap;
+  }
+  state->results[state->count++] = (du_result_t){
+    .path = copy, .bytes = bytes, .files = files
+  };
+  pthread_mutex_unlock(&state->lock);
+  return 0;
+}
+
+
+/**
+ * Counts one entry; called from every walker thread.
+ * @param entry Entry found.
+ * @param arg The du_state_t.
+ * @return JBOX_WALK_CONTINUE, JBOX_WALK_SKIP for a directory that cannot
+ *         be stat'ed, or JBOX_WALK_STOP if out of memory.
+ */
+static int du_visit(jbox_walk_entry_t *entry, void *arg) {
+  du_state_t *state = arg;
+  du_dir_t *parent = entry->parent_data;
+
+  du_stat_t st;
+  if (du_stat(entry->dir_fd, entry->name, entry->depth == 0, &st) != 0) {
+    if (errno != ENOENT || entry->depth == 0) {
+      fprintf(stderr, "du: cannot access '%s': %s\n", entry->path,
+              strerror(errno));
+      note_failure(state, 0);
+    }
+    return JBOX_WALK_SKIP;
+  }
+
+  long long usage = state->apparent ? st.size : st.blocks * 512;
+  if (!S_ISDIR(st.mode) && st.nlink > 1) {
+    int added = inode_add(state, st.dev, st.ino);
+    if (added < 0) {
+      note_failure(state, 1);
+      return JBOX_WALK_STOP;
+    }
+    if (added == 0) usage = 0;
+  }
+
+  if (S_ISDIR(st.mode) && entry->type == DT_DIR) {
+    size_t len = strlen(entry->path);
+    du_dir_t *dir = malloc(sizeof(*dir) + len + 1);
+    if (!dir) {
+      note_failure(state, 1);
+      return JBOX_WALK_STOP;
+    }
+    dir->parent = parent;
+    atomic_init(&dir->bytes, usage);
+    atomic_init(&dir->files, 0);
+    dir->depth = entry->depth;
+    memcpy(dir->path, entry->path, len + 1);
+    entry->data = dir;
+    return JBOX_WALK_CONTINUE;
+  }
+
+  if (parent) {
+    atomic_fetch_add(&parent->bytes, usage);
+    atomic_fetch_add(&parent->files, 1);
+  } else if (emit_total(state, entry->path, usage, 1) != 0) {
+    note_failure(state, 1);
+    return JBOX_WALK_STOP;
+  }
+  return JBOX_WALK_CONTINUE;
+}
+
+
+/**
+ * Finishes a directory once everything below it is counted.
+ * @param data The du_dir_t.
+ * @param arg The du_state_t.
+ */
+static void du_leave(void *data, void *arg) {
+  du_state_t *state = arg;
+  du_dir_t *dir = data;
+  long long bytes = atomic_load(&dir->bytes);
+  long long files = atomic_load(&dir->files);
+
+  if (dir->parent) {
+    atomic_fetch_add(&dir->parent->bytes, bytes);
+    atomic_fetch_add(&dir->parent->files, files);
+  }
+  if ((state->max_depth < 0 || dir->depth <= state->max_depth) &&
+      !jbox_is_interrupted() &&
+      emit_total(state, dir->path, bytes, files) != 0) {
+    note_failure(state, 1);
+  }
+  free(dir);
+}
+
+
+/**
+ * Report a directory that could not be read.
+ * @param path Its path.
+ * @param err errno of the failure.
+ * @param arg The du_state_t.
+ */
+static void du_error(const char *path, int err, void *arg) {
+  fprintf(stderr, "du: cannot read directory '%s': %s\n", path,
+          strerror(err));
+  note_failure(arg, 0);
+}
+
+
+/**
+ * Orders totals as du prints them: depth-first by name, each directory
+ * after everything inside it.
+ * @param a First du_result_t.
+ * @param b Second du_result_t.
+ * @return Comparison result for qsort.
+ */
+static int compare_results(const void *a, const void *b) {
+  const char *x = ((const du_result_t *)a)->path;
+  const char *y = ((const du_result_t *)b)->path;
+  size_t x_len = strlen(x);
+  size_t y_len = strlen(y);
+
+  if (x_len < y_len && strncmp(x, y, x_len) == 0 &&
+      (y[x_len] == '/' || (x_len > 0 && x[x_len - 1] == '/'))) {
+    return 1;           /* x contains y */
+  }
+  if (y_len < x_len && strncmp(x, y, y_len) == 0 &&
+      (x[y_len] == '/' || (y_len > 0 && y[y_len - 1] == '/'))) {
+    return -1;
+  }
+  return jbox_walk_compare_paths(x, y);
+}
+
+
+/**
+ * Print and free the collected totals.
+ * @param state Shared state.
+ */
+static void print_results(du_state_t *state) {
+  if (state->count > 1) {
+    qsort(state->results, state->count, sizeof(du_result_t),
+          compare_results);
+  }
+
+  for (size_t i = 0; i < state->count; i++) {
+    const du_result_t *r = &state->results[i];
+    if (state->format == DU_OUT_JSON) {
+      fputs(state->first_json ? "  " : ",\n  ", jbox_stdout());
+      state->first_json = 0;
+      print_json_total(r->path, r->bytes, r->files);
+    } else if (state->in_bytes) {
+      jbox_printf("%lld\t%s\n", r->bytes, r->path);
+    } else {
+      jbox_printf("%lld\t%s\n", (r->bytes + 1023) / 1024, r->path);
+    }
+    free(r->path);
+  }
+  state->count = 0;
+}
+
+
+/**
+ * Main entry point for the du command.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return Exit status (0 on success, 1 on error, 130 on interrupt).
+ */
+static int du_run(int argc, char **argv) {
+  du_args_t args;
+  build_du_argtable(&args);
+
+  jbox_setup_sigint_handler();
+
+  int nerrors = arg_parse(argc, argv, args.argtable);
+
+  if (args.help->count > 0) {
+    du_print_usage(jbox_stdout());
+    cleanup_du_argtable(&args);
+    return 0;
+  }
+
+  if (nerrors > 0) {
+    arg_print_errors(stderr, args.end, "du");
+    fprintf(stderr, "Try 'du --help' for more information.\n");
+    cleanup_du_argtable(&args);
+    return 1;
+  }
+
+  du_state_t *state = calloc(1, sizeof(*state));
+  if (!state) {
+    fprintf(stderr, "du: out of memory\n");
+    cleanup_du_argtable(&args);
+    return 1;
+  }
+  state->apparent = args.apparent->count > 0;
+  state->in_bytes = args.bytes->count > 0;
+  state->first_json = 1;
+  state->max_depth = -1;
+  if (args.summarize->count > 0) {
+    state->max_depth = 0;
+  } else if (args.max_depth->count > 0) {
+    state->max_depth = args.max_depth->ival[0];
+    if (state->max_depth < 0) {
+      fprintf(stderr, "du: --max-depth must not be negative\n");
+      free(state);
+      cleanup_du_argtable(&args);
+      return 1;
+    }
+  }
+  if (args.json_stream->count > 0) {
+    state->format = DU_OUT_STREAM;
+  } else if (args.json->count > 0) {
+    state->format = DU_OUT_JSON;
+  }
+
+  pthread_mutex_init(&state->lock, NULL);
+  for (int i = 0; i < DU_INODE_SHARDS; i++) {
+    pthread_mutex_init(&state->shards[i].lock, NULL);
+  }
+
+  jbox_walk_options_t opts = {
+    .max_depth = -1,
+    .visit = du_visit,
+    .error = du_error,
+    .leave = du_leave,
+    .arg = state,
+  };
+
+  if (state->format == DU_OUT_JSON) {
+    jbox_printf("[\n");
+  }
+
+  int interrupted = 0;
+  int path_count = args.paths->count > 0 ? args.paths->count : 1;
+  for (int i = 0; i < path_count && !interrupted; i++) {
+    const char *root = args.paths->count > 0 ? args.paths->filename[i] : ".";
+    int rc = jbox_walk(root, &opts);
+    if (rc == -2) {
+      interrupted = 1;
+    } else if (rc == -1) {
+      state->out_of_memory = 1;
+    }
+    if (!interrupted) {
+      print_results(state);
+    }
+    if (state->out_of_memory) break;
+  }
+
+  if (state->format == DU_OUT_JSON) {
+    jbox_printf(state->first_json ? "]\n" : "\n]\n");
+  }
+  if (state->out_of_memory) {
+    fprintf(stderr, "du: out of memory\n");
+  }
+  fflush(jbox_stdout());
+
+  int status = interrupted ? 130   /* 128 + SIGINT(2) */
+               : state->failed || state->out_of_memory ? 1 : 0;
+
+  for (size_t i = 0; i < state->count; i++) {
+    free(state->results[i].path);
+  }
+  free(state->results);
+  for (int i = 0; i < DU_INODE_SHARDS; i++) {
+    free(state->shards[i].slots);
+    pthread_mutex_destroy(&state->shards[i].lock);
+  }
+  pthread_mutex_destroy(&state->lock);
+  free(state);
+  cleanup_du_argtable(&args);
+  return status;
+}
+
+
+/**
+ * Command specification for du command.
+ */
+const jshell_cmd_spec_t cmd_du_spec = {
+  .name = "du",
+  .summary = "summarize disk usage",
+  .long_help = "Print the disk usage of each PATH (default: the current "
+               "directory) and of every directory below it, in KiB or "
+               "with -b in bytes. Directories are read on all cores and "
+               "files with several hard links are counted once. "
+               "--max-depth or -s limits which totals are printed; "
+               "--json-stream prints each directory's total as soon as "
+               "it is known.",
+  .type = CMD_EXTERNAL,
+  .run = du_run,
+  .print_usage = du_print_usage,
+  .describe_args = du_describe_args,
+  .cache_scope = du_cache_scope
+};
+
+
+/**
+ * Registers the du command with the shell command registry.
+ */
+void jshell_register_du_command(void) {
+  jshell_register_command(&cmd_du_spec);
+}
@@ -0,0 +1,10 @@
+#ifndef CMD_DU_H
+#define CMD_DU_H
+
+#include "jshell/jshell_cmd_registry.h"
+
+extern const jshell_cmd_spec_t cmd_du_spec;
+
+void jshell_register_du_command(void);
+
+#endif
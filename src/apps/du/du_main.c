@@ -0,0 +1,17 @@
+/**
+ * @file du_main.c
+ * @brief Main entry point for standalone du command.
+ */
+
+#include "cmd_du.h"
+
+
+/**
+ * Main entry point for standalone du binary.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return Exit status from du_run.
+ */
+int main(int argc, char **argv) {
+  return cmd_du_spec.run(argc, argv);
+}
@@ -9,6 +9,7 @@
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_ctx.h"
 
 
 /**
@@ -69,6 +70,20 @@ static void echo_print_usage(FILE *out) {
 }
 
 
+/**
+ * Passes the echo argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void echo_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  echo_args_t args;
+  build_echo_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_echo_argtable(&args);
+}
+
+
 /**
  * Main entry point for the echo command.
  *
@@ -85,7 +100,7 @@ static int echo_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    echo_print_usage(stdout);
+    echo_print_usage(jbox_stdout());
     cleanup_echo_argtable(&args);
     return 0;
   }
@@ -99,13 +114,13 @@ static int echo_run(int argc, char **argv) {
 
   for (int i = 0; i < args.text->count; i++) {
     if (i > 0) {
-      printf(" ");
+      jbox_printf(" ");
     }
-    printf("%s", args.text->sval[i]);
+    jbox_printf("%s", args.text->sval[i]);
   }
 
   if (args.no_newline->count == 0) {
-    printf("\n");
+    jbox_printf("\n");
   }
 
   cleanup_echo_argtable(&args);
@@ -123,7 +138,8 @@ const jshell_cmd_spec_t cmd_echo_spec = {
                "a newline. Use -n to suppress the trailing newline.",
   .type = CMD_EXTERNAL,
   .run = echo_run,
-  .print_usage = echo_print_usage
+  .print_usage = echo_print_usage,
+  .describe_args = echo_describe_args
 };
 
 
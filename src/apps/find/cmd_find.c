@@ -0,0 +1,626 @@
+/**
+ * @file cmd_find.c
+ * @brief Find command implementation for jshell.
+ *
+ * Each PATH is walked with jbox_walk() on every core. Entries are tested
+ * against the predicates by whichever walker thread finds them, and the
+ * matches are collected and sorted before printing, so the output is
+ * the same from run to run.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "argtable3.h"
+#include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_ctx.h"
+#include "utils/jbox_json.h"
+#include "utils/jbox_signals.h"
+#include "utils/jbox_walk.h"
+
+
+/** How a number given as +N, -N or N is compared */
+enum {
+  FIND_CMP_EQ,
+  FIND_CMP_GT,              /* +N: more than N */
+  FIND_CMP_LT               /* -N: less than N */
+};
+
+/** A --size or --mtime test */
+typedef struct {
+  int set;
+  int cmp;
+  long long value;
+  long long unit;           /* Bytes or seconds per counted unit */
+} find_number_t;
+
+/** Predicates, all of which an entry must pass */
+typedef struct {
+  const char *name;         /* --name or --iname pattern, or NULL */
+  int name_flags;           /* FNM_CASEFOLD for --iname */
+  unsigned char type;       /* DT_* for --type, or DT_UNKNOWN for any */
+  find_number_t size;
+  find_number_t mtime;
+  int min_depth;
+  time_t now;
+} find_tests_t;
+
+/** An entry that passed */
+typedef struct {
+  char *path;
+  unsigned char type;
+  long long size;
+  time_t mtime;
+} find_match_t;
+
+/** State shared by the walker threads */
+typedef struct {
+  const find_tests_t *tests;
+  int need_stat;            /* Size or mtime is tested or printed */
+  find_match_t *matches;
+  size_t count;
+  size_t capacity;
+  int failed;               /* An entry could not be read */
+  int out_of_memory;
+  pthread_mutex_t lock;
+} find_state_t;
+
+
+typedef struct {
+  struct arg_lit *help;
+  struct arg_str *name;
+  struct arg_str *iname;
+  struct arg_str *type;
+  struct arg_str *size;
+  struct arg_str *mtime;
+  struct arg_int *maxdepth;
+  struct arg_int *mindepth;
+  struct arg_lit *print0;
+  struct arg_lit *json;
+  struct arg_file *paths;
+  struct arg_end *end;
+  void *argtable[12];
+} find_args_t;
+
+
+/**
+ * Build the argument table for the find command.
+ * @param args Pointer to find_args_t structure to populate.
+ */
+static void build_find_argtable(find_args_t *args) {
+  args->help     = arg_lit0("h", "help", "display this help and exit");
+  args->name     = arg_str0(NULL, "name", "PATTERN",
+                            "base name matches shell PATTERN");
+  args->iname    = arg_str0(NULL, "iname", "PATTERN",
+                            "like --name, ignoring case");
+  args->type     = arg_str0(NULL, "type", "TYPE",
+                            "f file, d directory, l symlink, p fifo, "
+                            "s socket, b/c device");
+  args->size     = arg_str0(NULL, "size", "[+-]N[ckMG]",
+                            "size is N (more than +N, less than -N) bytes, "
+                            "or KiB/MiB/GiB with k/M/G");
+  args->mtime    = arg_str0(NULL, "mtime", "[+-]N",
+                            "modified N whole days ago (more than +N, "
+                            "less than -N)");
+  args->maxdepth = arg_int0(NULL, "maxdepth", "N",
+                            "descend at most N levels below each PATH");
+  args->mindepth = arg_int0(NULL, "mindepth", "N",
+                            "skip entries less than N levels down");
+  args->print0   = arg_lit0("0", "print0",
+                            "end each path with NUL instead of newline");
+  args->json     = arg_lit0(NULL, "json", "output in JSON format");
+  args->paths    = arg_filen(NULL, NULL, "PATH", 0, 1000,
+                             "where to start (default: .)");
+  args->end      = arg_end(20);
+
+  args->argtable[0] = args->help;
+  args->argtable[1] = args->name;
+  args->argtable[2] = args->iname;
+  args->argtable[3] = args->type;
+  args->argtable[4] = args->size;
+  args->argtable[5] = args->mtime;
+  args->argtable[6] = args->maxdepth;
+  args->argtable[7] = args->mindepth;
+  args->argtable[8] = args->print0;
+  args->argtable[9] = args->json;
+  args->argtable[10] = args->paths;
+  args->argtable[11] = args->end;
+}
+
+
+/**
+ * Clean up and free the argument table.
+ * @param args Pointer to find_args_t structure to clean up.
+ */
+static void cleanup_find_argtable(find_args_t *args) {
+  arg_freetable(args->argtable,
+                sizeof(args->argtable) / sizeof(args->argtable[0]));
+}
+
+
+/**
+ * Print usage information for the find command.
+ * @param out Output stream to write usage information to.
+ */
+static void find_print_usage(FILE *out) {
+  find_args_t args;
+  build_find_argtable(&args);
+  fprintf(out, "Usage: find");
+  arg_print_syntax(out, args.argtable, "\n");
+  fprintf(out, "Search directory trees for files matching every test "
+               "given.\n\n");
+  fprintf(out, "Options:\n");
+  arg_print_glossary(out, args.argtable, "  %-24s %s\n");
+  cleanup_find_argtable(&args);
+}
+
+
+/**
+ * Passes the find argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void find_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  find_args_t args;
+  build_find_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_find_argtable(&args);
+}
+
+
+/**
+ * Tells the result cache what the output of find depends on: everything
+ * below the named paths; not with --mtime, which compares with the clock.
+ *
+ * @param argc Number of arguments
+ * @param argv Array of argument strings
+ * @return How this run may be cached
+ */
+static jshell_cmd_cache_t find_cache_scope(int argc, char **argv) {
+  find_args_t args;
+  build_find_argtable(&args);
+  int nerrors = arg_parse(argc, argv, args.argtable);
+  jshell_cmd_cache_t scope = CMD_CACHE_NONE;
+  if (nerrors == 0 && args.help->count == 0
+      && args.mtime->count == 0) {
+    scope = CMD_CACHE_TREES;
+  }
+  cleanup_find_argtable(&args);
+  return scope;
+}
+
+
+/**
+ * Get the name --json prints for a file type.
+ * @param type DT_* type.
+ * @return Type name, as ls --json prints it.
+ */
+static const char *get_type_string(unsigned char type) {
+  switch (type) {
+    case DT_DIR:  return "directory";
+    case DT_LNK:  return "symlink";
+    case DT_CHR:  return "chardev";
+    case DT_BLK:  return "blockdev";
+    case DT_FIFO: return "fifo";
+    case DT_SOCK: return "socket";
+    default:      return "file";
+  }
+}
+
+
+/**
+ * Parse a --type letter.
+ * @param text Argument text.
+ * @return DT_* type, or DT_UNKNOWN if not recognized.
+ */
+static unsigned char parse_type(const char *text) {
+  if (text[0] == '\0' || text[1] != '\0') return DT_UNKNOWN;
+  switch (text[0]) {
+    case 'f': return DT_REG;
+    case 'd': return DT_DIR;
+    case 'l': return DT_LNK;
+    case 'p': return DT_FIFO;
+    case 's': return DT_SOCK;
+    case 'b': return DT_BLK;
+    case 'c': return DT_CHR;
+    default:  return DT_UNKNOWN;
+  }
+}
+
+
+/**
+ * Parse a [+-]N number with an optional unit suffix.
+ * @param text Argument text.
+ * @param units Accepted suffixes, e.g. "ckMG", or "" for none.
+ * @param scales Unit size for each suffix.
+ * @param unit Unit size without a suffix.
+ * @param num Test to fill in.
+ * @return 0 on success, -1 if the text is not a valid number.
+ */
+static int parse_number(const char *text, const char *units,
+                        const long long *scales, long long unit,
+                        find_number_t *num) {
+  num->cmp = FIND_CMP_EQ;
+  if (*text == '+') {
+    num->cmp = FIND_CMP_GT;
+    text++;
+  } else if (*text == '-') {
+    num->cmp = FIND_CMP_LT;
+    text++;
+  }
+  if (!isdigit((unsigned char)*text)) return -1;
+
+  char *end;
+  errno = 0;
+  num->value = strtoll(text, &end, 10);
+  if (errno != 0) return -1;
+
+  num->unit = unit;
+  if (*end != '\0') {
+    const char *suffix = end[1] == '\0' ? strchr(units, *end) : NULL;
+    if (!suffix) return -1;
+    num->unit = scales[suffix - units];
+  }
+  num->set = 1;
+  return 0;
+}
+
+
+/**
+ * Compare a count of whole units against a test.
+ * @param num Test.
+ * @param units Bytes or days, in the test's unit.
+ * @return Non-zero if the test passes.
+ */
+static int number_matches(const find_number_t *num, long long units) {
+  switch (num->cmp) {
+    case FIND_CMP_GT: return units > num->value;
+    case FIND_CMP_LT: return units < num->value;
+    default:          return units == num->value;
+  }
+}
+
+
+/**
+ * Record an entry that passed every test.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int add_match(find_state_t *state, const char *path,
+                     unsigned char type, const struct stat *st) {
+  char *copy = strdup(path);
+  if (!copy) return -1;
+
+  pthread_mutex_lock(&state->lock);
+  if (state->count >= state->capacity) {
+    size_t new_cap = state->capacity == 0 ? 256 : state->capacity * 2;
+    find_match_t *grown = realloc(state->matches,
+                                  new_cap * sizeof(find_match_t));
+    if (!grown) {
+      pthread_mutex_unlock(&state->lock);
+      free(copy);
+      return -1;
+    }
+    state->matches = grown;
+    state->capacity = new_cap;
+  }
+  state->matches[state->count++] = (find_match_t){
+    .path = copy,
+    .type = type,
+    .size = st ? (long long)st->st_size : 0,
+    .mtime = st ? st->st_mtime : 0,
+  };
+  pthread_mutex_unlock(&state->lock);
+  return 0;
+}
+
+
+/**
+ * Tests one entry; called from every walker thread.
+ * @param entry Entry found.
+ * @param arg The find_state_t.
+ * @return JBOX_WALK_CONTINUE, or JBOX_WALK_STOP if out of memory.
+ */
+static int find_visit(jbox_walk_entry_t *entry, void *arg) {
+  find_state_t *state = arg;
+  const find_tests_t *tests = state->tests;
+
+  if (entry->depth < tests->min_depth) return JBOX_WALK_CONTINUE;
+  if (tests->type != DT_UNKNOWN && entry->type != tests->type) {
+    return JBOX_WALK_CONTINUE;
+  }
+  if (tests->name) {
+    /* The name of a root is its last component, as find matches it */
+    const char *name = entry->name;
+    if (entry->depth == 0) {
+      const char *slash = strrchr(name, '/');
+      if (slash && slash[1] != '\0') name = slash + 1;
+    }
+    if (fnmatch(tests->name, name, tests->name_flags) != 0) {
+      return JBOX_WALK_CONTINUE;
+    }
+  }
+
+  struct stat st;
+  int have_stat = 0;
+  if (state->need_stat) {
+    if (fstatat(entry->dir_fd, entry->name, &st,
+                entry->depth == 0 ? 0 : AT_SYMLINK_NOFOLLOW) != 0) {
+      if (errno != ENOENT) {
+        fprintf(stderr, "find: %s: %s\n", entry->path, strerror(errno));
+        pthread_mutex_lock(&state->lock);
+        state->failed = 1;
+        pthread_mutex_unlock(&state->lock);
+      }
+      return JBOX_WALK_CONTINUE;
+    }
+    have_stat = 1;
+    /* Sizes count partial units as whole ones, so a 1-byte file is 1k;
+     * ages count whole days only, as find does */
+    long long unit = tests->size.unit;
+    if (tests->size.set &&
+        !number_matches(&tests->size, (st.st_size + unit - 1) / unit)) {
+      return JBOX_WALK_CONTINUE;
+    }
+    long long age = (long long)(tests->now - st.st_mtime);
+    if (tests->mtime.set &&
+        !number_matches(&tests->mtime,
+                        age < 0 ? 0 : age / tests->mtime.unit)) {
+      return JBOX_WALK_CONTINUE;
+    }
+  }
+
+  if (add_match(state, entry->path, entry->type,
+                have_stat ? &st : NULL) != 0) {
+    pthread_mutex_lock(&state->lock);
+    state->out_of_memory = 1;
+    pthread_mutex_unlock(&state->lock);
+    return JBOX_WALK_STOP;
+  }
+  return JBOX_WALK_CONTINUE;
+}
+
+
+/**
+ * Report a directory or entry that could not be read.
+ * @param path Its path.
+ * @param err errno of the failure.
+ * @param arg The find_state_t.
+ */
+static void find_error(const char *path, int err, void *arg) {
+  find_state_t *state = arg;
+  fprintf(stderr, "find: %s: %s\n", path, strerror(err));
+  pthread_mutex_lock(&state->lock);
+  state->failed = 1;
+  pthread_mutex_unlock(&state->lock);
+}
+
+
+/**
+ * Orders matches as a depth-first walk by name would.
+ * @param a First find_match_t.
+ * @param b Second find_match_t.
+ * @return Comparison result for qsort.
+ */
+static int compare_matches(const void *a, const void *b) {
+  const find_match_t *x = a;
+  const find_match_t *y = b;
+  return jbox_walk_compare_paths(x->path, y->path);
+}
+
+
+/**
+ * Print the matches of one PATH.
+ * @param state Collected matches.
+ * @param json Print JSON objects instead of paths.
+ * @param print0 End paths with NUL.
+ * @param first_json Whether no JSON object has been printed yet.
+ */
+static void print_matches(const find_state_t *state, int json, int print0,
+                          int *first_json) {
+  FILE *out = jbox_stdout();
+  for (size_t i = 0; i < state->count; i++) {
+    const find_match_t *m = &state->matches[i];
+    if (!json) {
+      fputs(m->path, out);
+      fputc(print0 ? '\0' : '\n', out);
+      continue;
+    }
+
+    fputs(*first_json ? "  {\"path\": " : ",\n  {\"path\": ", out);
+    *first_json = 0;
+    jbox_json_write_string(out, m->path);
+    jbox_printf(", \"type\": \"%s\", \"size\": %lld, \"mtime\": %lld}",
+                get_type_string(m->type), m->size, (long long)m->mtime);
+  }
+}
+
+
+/**
+ * Free the matches of one PATH.
+ * @param state Collected matches.
+ */
+static void free_matches(find_state_t *state) {
+  for (size_t i = 0; i < state->count; i++) {
+    free(state->matches[i].path);
+  }
+  free(state->matches);
+  state->matches = NULL;
+  state->count = 0;
+  state->capacity = 0;
+}
+
+
+/**
+ * Main entry point for the find command.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return Exit status (0 on success, 1 on error, 130 on interrupt).
+ */
+static int find_run(int argc, char **argv) {
+  find_args_t args;
+  build_find_argtable(&args);
+
+  jbox_setup_sigint_handler();
+
+  int nerrors = arg_parse(argc, argv, args.argtable);
+
+  if (args.help->count > 0) {
+    find_print_usage(jbox_stdout());
+    cleanup_find_argtable(&args);
+    return 0;
+  }
+
+  if (nerrors > 0) {
+    arg_print_errors(stderr, args.end, "find");
+    fprintf(stderr, "Try 'find --help' for more information.\n");
+    cleanup_find_argtable(&args);
+    return 1;
+  }
+
+  find_tests_t tests = { .type = DT_UNKNOWN, .now = time(NULL) };
+  if (args.name->count > 0) {
+    tests.name = args.name->sval[0];
+  } else if (args.iname->count > 0) {
+    tests.name = args.iname->sval[0];
+    tests.name_flags = FNM_CASEFOLD;
+  }
+
+  if (args.type->count > 0) {
+    tests.type = parse_type(args.type->sval[0]);
+    if (tests.type == DT_UNKNOWN) {
+      fprintf(stderr, "find: unknown type '%s'\n", args.type->sval[0]);
+      cleanup_find_argtable(&args);
+      return 1;
+    }
+  }
+
+  static const long long size_scales[] = {
+    1, 1024, 1024 * 1024, 1024 * 1024 * 1024
+  };
+  if (args.size->count > 0 &&
+      parse_number(args.size->sval[0], "ckMG", size_scales, 1,
+                   &tests.size) != 0) {
+    fprintf(stderr, "find: invalid size '%s'\n", args.size->sval[0]);
+    cleanup_find_argtable(&args);
+    return 1;
+  }
+
+  if (args.mtime->count > 0 &&
+      parse_number(args.mtime->sval[0], "", NULL, 86400,
+                   &tests.mtime) != 0) {
+    fprintf(stderr, "find: invalid mtime '%s'\n", args.mtime->sval[0]);
+    cleanup_find_argtable(&args);
+    return 1;
+  }
+
+  int max_depth = -1;
+  if (args.maxdepth->count > 0) {
+    max_depth = args.maxdepth->ival[0];
+    if (max_depth < 0) {
+      fprintf(stderr, "find: --maxdepth must not be negative\n");
+      cleanup_find_argtable(&args);
+      return 1;
+    }
+  }
+  if (args.mindepth->count > 0) {
+    tests.min_depth = args.mindepth->ival[0];
+  }
+
+  int json = args.json->count > 0;
+  int print0 = args.print0->count > 0;
+
+  find_state_t state = {
+    .tests = &tests,
+    .need_stat = tests.size.set || tests.mtime.set || json,
+  };
+  pthread_mutex_init(&state.lock, NULL);
+
+  jbox_walk_options_t opts = {
+    .max_depth = max_depth,
+    .visit = find_visit,
+    .error = find_error,
+    .arg = &state,
+  };
+
+  if (json) {
+    jbox_printf("[\n");
+  }
+
+  int interrupted = 0;
+  int first_json = 1;
+  int path_count = args.paths->count > 0 ? args.paths->count : 1;
+  for (int i = 0; i < path_count && !interrupted; i++) {
+    const char *root = args.paths->count > 0 ? args.paths->filename[i] : ".";
+    int rc = jbox_walk(root, &opts);
+    if (rc == -2) {
+      interrupted = 1;
+    } else if (rc == -1) {
+      state.out_of_memory = 1;
+    }
+
+    if (state.count > 1) {
+      qsort(state.matches, state.count, sizeof(find_match_t),
+            compare_matches);
+    }
+    if (!interrupted) {
+      print_matches(&state, json, print0, &first_json);
+    }
+    free_matches(&state);
+    if (state.out_of_memory) break;
+  }
+
+  if (json) {
+    jbox_printf(first_json ? "]\n" : "\n]\n");
+  }
+  if (state.out_of_memory) {
+    fprintf(stderr, "find: out of memory\n");
+  }
+
+  fflush(jbox_stdout());
+  pthread_mutex_destroy(&state.lock);
+  cleanup_find_argtable(&args);
+
+  if (interrupted) {
+    return 130;  /* 128 + SIGINT(2) */
+  }
+  return state.failed || state.out_of_memory ? 1 : 0;
+}
+
+
+/**
+ * Command specification for find command.
+ */
+const jshell_cmd_spec_t cmd_find_spec = {
+  .name = "find",
+  .summary = "search directory trees for files",
+  .long_help = "Walk each PATH (default: the current directory) and print "
+               "every entry that passes all of the tests given: --name or "
+               "--iname on the base name, --type, --size and --mtime. "
+               "Directories are read on all cores; matches are printed "
+               "sorted, depth-first by name. Symlinks are not followed.",
+  .type = CMD_EXTERNAL,
+  .run = find_run,
+  .print_usage = find_print_usage,
+  .describe_args = find_describe_args,
+  .cache_scope = find_cache_scope
+};
+
+
+/**
+ * Registers the find command with the shell command registry.
+ */
+void jshell_register_find_command(void) {
+  jshell_register_command(&cmd_find_spec);
+}
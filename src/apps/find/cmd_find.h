@@ -0,0 +1,10 @@
+#ifndef CMD_FIND_H
+#define CMD_FIND_H
+
+#include "jshell/jshell_cmd_registry.h"
+
+extern const jshell_cmd_spec_t cmd_find_spec;
+
+void jshell_register_find_command(void);
+
+#endif
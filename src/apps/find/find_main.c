@@ -0,0 +1,17 @@
+/**
+ * @file find_main.c
+ * @brief Main entry point for standalone find command.
+ */
+
+#include "cmd_find.h"
+
+
+/**
+ * Main entry point for standalone find binary.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return Exit status from find_run.
+ */
+int main(int argc, char **argv) {
+  return cmd_find_spec.run(argc, argv);
+}
@@ -15,6 +15,7 @@
 #include "cmd_ftp.h"
 #include "ftp_client.h"
 #include "ftp_interactive.h"
+#include "ftp_pool.h"
 
 
 /** Default FTP server port. */
@@ -29,9 +30,17 @@ typedef struct {
   struct arg_str *host;
   struct arg_int *port;
   struct arg_str *user;
+  struct arg_lit *active;
+  struct arg_lit *tls;
+  struct arg_str *tls_ca;
+  struct arg_lit *insecure;
+  struct arg_lit *compress;
+  struct arg_int *keep;
+  struct arg_str *batch;
   struct arg_lit *json;
+  struct arg_str *command;
   struct arg_end *end;
-  void *argtable[6];
+  void *argtable[14];
 } ftp_args_t;
 
 
@@ -48,15 +57,44 @@ static void build_ftp_argtable(ftp_args_t *args) {
                         "server port (default: 21021)");
   args->user = arg_str0("u", "user", "<user>",
                         "username for login (default: anonymous)");
+  args->active = arg_lit0(NULL, "active",
+                          "data connections with PORT, not EPSV/PASV");
+  args->tls = arg_lit0(NULL, "tls",
+                       "secure the session with AUTH TLS (FTPS)");
+  args->tls_ca = arg_str0(NULL, "tls-ca", "<file>",
+                          "trust the authorities in this PEM file");
+  args->insecure = arg_lit0(NULL, "insecure",
+                            "do not check the server's certificate");
+  args->compress = arg_lit0("z", "compress",
+                            "deflate transfers with MODE Z when the "
+                            "server has it");
+  args->keep = arg_int0("k", "keep", "<seconds>",
+                        "reuse a session kept by an earlier ftp command, "
+                        "and keep this one for the next that many idle "
+                        "seconds");
+  args->batch = arg_str0("b", "batch", "<file>",
+                         "run the commands in file ('-' for stdin), "
+                         "pipelining mkdir and cd");
   args->json = arg_lit0(NULL, "json", "output in JSON format");
+  args->command = arg_strn(NULL, NULL, "COMMAND", 0, 64,
+                           "run this one command and exit, e.g. "
+                           "'get FILE -' to write FILE to stdout");
   args->end = arg_end(20);
 
   args->argtable[0] = args->help;
   args->argtable[1] = args->host;
   args->argtable[2] = args->port;
   args->argtable[3] = args->user;
-  args->argtable[4] = args->json;
-  args->argtable[5] = args->end;
+  args->argtable[4] = args->active;
+  args->argtable[5] = args->tls;
+  args->argtable[6] = args->tls_ca;
+  args->argtable[7] = args->insecure;
+  args->argtable[8] = args->compress;
+  args->argtable[9] = args->keep;
+  args->argtable[10] = args->batch;
+  args->argtable[11] = args->json;
+  args->argtable[12] = args->command;
+  args->argtable[13] = args->end;
 }
 
 
@@ -87,18 +125,64 @@ static void ftp_print_usage(FILE *out) {
   arg_print_glossary(out, args.argtable, "  %-25s %s\n");
   fprintf(out, "\nInteractive commands:\n");
   fprintf(out, "  ls [path]           List directory contents\n");
+  fprintf(out, "  mls [path]          List type, size and time of entries\n");
   fprintf(out, "  cd <path>           Change directory\n");
   fprintf(out, "  pwd                 Print working directory\n");
-  fprintf(out, "  get <remote> [local] Download file\n");
-  fprintf(out, "  put <local> [remote] Upload file\n");
+  fprintf(out, "  get <remote> [local] Download file ('-' for stdout)\n");
+  fprintf(out, "  put <local> [remote] Upload file ('-' for stdin)\n");
+  fprintf(out, "      (get --resume and put --append finish a partial "
+               "transfer)\n");
+  fprintf(out, "  mget <remote>...    Download files over parallel sessions\n");
+  fprintf(out, "  mput <local>...     Upload files over parallel sessions\n");
+  fprintf(out, "  mirror <remote> <local>\n"
+               "                      Download what differs (-R to upload; "
+               "--delete,\n"
+               "                      --checksum)\n");
   fprintf(out, "  mkdir <dir>         Create directory\n");
   fprintf(out, "  help                Show commands\n");
   fprintf(out, "  quit                Disconnect and exit\n");
 
+  fprintf(out, "\nA COMMAND after the options runs alone, with the "
+               "session's messages on\nstderr, so that data can be piped:\n");
+  fprintf(out, "  ftp -H host get log.gz - | rg -z err\n");
+  fprintf(out, "  tar cz src | ftp -H host put - src.tar.gz\n");
+  fprintf(out, "  ftp -H host mirror --delete releases ./releases\n");
+  fprintf(out, "  ftp -z -H host get logs/app.log -\n");
+  fprintf(out, "\nWith --keep, commands in a row share one logged-in "
+               "session:\n");
+  fprintf(out, "  for f in a b c; do ftp -k 30 -H host get $f; done\n");
+
+  cleanup_ftp_argtable(&args);
+}
+
+
+/**
+ * @brief Passes the ftp argtable to visit, for tool
+ *        schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void ftp_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  ftp_args_t args;
+  build_ftp_argtable(&args);
+  visit(args.argtable, userdata);
   cleanup_ftp_argtable(&args);
 }
 
 
+/**
+ * @brief Close a batch script unless it is stdin.
+ *
+ * @param script Script stream, or NULL.
+ */
+static void close_script(FILE *script) {
+  if (script && script != stdin) {
+    fclose(script);
+  }
+}
+
+
 /**
  * @brief Main entry point for the ftp command.
  *
@@ -149,66 +233,184 @@ static int ftp_run(int argc, char **argv) {
   }
 
   bool json_output = args.json->count > 0;
-
-  cleanup_ftp_argtable(&args);
+  bool active = args.active->count > 0;
+  bool tls = args.tls->count > 0;
+  bool compress = args.compress->count > 0;
+  int keep = args.keep->count > 0 ? args.keep->ival[0] : 0;
+  if (keep < 0) {
+    fprintf(stderr, "ftp: invalid keep time: %d\n", keep);
+    cleanup_ftp_argtable(&args);
+    return 1;
+  }
 
   /* Initialize session */
   ftp_session_t session;
   ftp_session_init(&session);
+  session.passive = !active;
+  session.tls_verify = args.insecure->count == 0;
+  if (args.tls_ca->count > 0) {
+    snprintf(session.tls_ca, sizeof(session.tls_ca), "%s",
+             args.tls_ca->sval[0]);
+  }
 
-  /* Connect to server */
-  if (json_output) {
-    printf("{\"action\":\"connect\",\"host\":\"%s\",\"port\":%d,", host, port);
-  } else {
-    printf("Connecting to %s:%d...\n", host, port);
+  /* A single command leaves stdout to the data it may stream */
+  int command_argc = args.command->count;
+  if (command_argc > 0 && args.batch->count > 0) {
+    fprintf(stderr, "ftp: a command cannot be given with --batch\n");
+    cleanup_ftp_argtable(&args);
+    return 1;
+  }
+  char **command_argv = NULL;
+  if (command_argc > 0) {
+    command_argv = calloc((size_t)command_argc, sizeof(char *));
+    if (!command_argv) {
+      fprintf(stderr, "ftp: out of memory\n");
+      cleanup_ftp_argtable(&args);
+      return 1;
+    }
+    for (int i = 0; i < command_argc; i++) {
+      command_argv[i] = (char *)args.command->sval[i];
+    }
+  }
+  FILE *info = command_argc > 0 ? stderr : stdout;
+
+  /* Open the script before connecting, so a typo costs no session */
+  FILE *script = NULL;
+  if (args.batch->count > 0) {
+    const char *path = args.batch->sval[0];
+    script = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!script) {
+      fprintf(stderr, "ftp: cannot open %s\n", path);
+      cleanup_ftp_argtable(&args);
+      return 1;
+    }
   }
 
-  if (ftp_connect(&session, host, (uint16_t)port) < 0) {
+  cleanup_ftp_argtable(&args);
+
+  /* A kept session skips the connection, the greeting and the login */
+  char home[FTP_RESPONSE_MAX] = "";
+  bool reused = keep > 0 && !tls &&
+                ftp_pool_take(&session, host, (uint16_t)port, user, home,
+                              sizeof(home)) == 0;
+  if (reused) {
     if (json_output) {
-      printf("\"status\":\"error\",\"message\":\"connection failed\"}\n");
+      fprintf(info, "{\"action\":\"connect\",\"host\":\"%s\",\"port\":%d,"
+              "\"status\":\"ok\",\"reused\":true}\n", host, port);
     } else {
-      fprintf(stderr, "ftp: failed to connect to %s:%d\n", host, port);
+      fprintf(info, "Reusing session to %s:%d as %s\n", host, port, user);
     }
-    return 1;
-  }
-
-  if (json_output) {
-    printf("\"status\":\"ok\",\"response\":\"%s\"}\n",
-           ftp_last_response(&session));
   } else {
-    printf("Connected: %s\n", ftp_last_response(&session));
-  }
+    /* Connect to server */
+    if (json_output) {
+      fprintf(info, "{\"action\":\"connect\",\"host\":\"%s\",\"port\":%d,",
+              host, port);
+    } else {
+      fprintf(info, "Connecting to %s:%d...\n", host, port);
+    }
 
-  /* Login */
-  if (json_output) {
-    printf("{\"action\":\"login\",\"user\":\"%s\",", user);
-  } else {
-    printf("Logging in as %s...\n", user);
+    if (ftp_connect(&session, host, (uint16_t)port) < 0) {
+      if (json_output) {
+        fprintf(info,
+                "\"status\":\"error\",\"message\":\"connection failed\"}\n");
+      } else {
+        fprintf(stderr, "ftp: failed to connect to %s:%d\n", host, port);
+      }
+      close_script(script);
+      free(command_argv);
+      return 1;
+    }
+
+    if (json_output) {
+      fprintf(info, "\"status\":\"ok\",\"response\":\"%s\"}\n",
+              ftp_last_response(&session));
+    } else {
+      fprintf(info, "Connected: %s\n", ftp_last_response(&session));
+    }
+
+    /* Secure the session before the user name goes out */
+    if (tls) {
+      if (ftp_auth_tls(&session, NULL) < 0) {
+        if (json_output) {
+          fprintf(info, "{\"action\":\"auth\",\"status\":\"error\",");
+          fprintf(info, "\"response\":\"%s\"}\n", ftp_last_response(&session));
+        } else {
+          fprintf(stderr, "ftp: TLS failed: %s\n",
+                  ftp_last_response(&session));
+        }
+        ftp_close(&session);
+        close_script(script);
+        free(command_argv);
+        return 1;
+      }
+      if (json_output) {
+        fprintf(info, "{\"action\":\"auth\",\"status\":\"ok\","
+                "\"protocol\":\"%s\"}\n", ftp_tls_version(&session));
+      } else {
+        fprintf(info, "Secured with %s\n", ftp_tls_version(&session));
+      }
+    }
+
+    /* Login */
+    if (json_output) {
+      fprintf(info, "{\"action\":\"login\",\"user\":\"%s\",", user);
+    } else {
+      fprintf(info, "Logging in as %s...\n", user);
+    }
+
+    if (ftp_login(&session, user) < 0) {
+      if (json_output) {
+        fprintf(info, "\"status\":\"error\",\"message\":\"login failed\",");
+        fprintf(info, "\"response\":\"%s\"}\n", ftp_last_response(&session));
+      } else {
+        fprintf(stderr, "ftp: login failed: %s\n", ftp_last_response(&session));
+      }
+      ftp_close(&session);
+      close_script(script);
+      free(command_argv);
+      return 1;
+    }
+
+    if (json_output) {
+      fprintf(info, "\"status\":\"ok\",\"response\":\"%s\"}\n",
+              ftp_last_response(&session));
+    } else {
+      fprintf(info, "Logged in: %s\n", ftp_last_response(&session));
+    }
+
+    /* Remember where the session starts, to return there on reuse */
+    if (keep > 0 && !tls && ftp_pwd(&session, home, sizeof(home)) < 0) {
+      home[0] = '\0';
+    }
   }
 
-  if (ftp_login(&session, user) < 0) {
+  /* A server without MODE Z is still worth talking to */
+  if (compress != session.mode_z && ftp_mode_z(&session, compress) < 0) {
     if (json_output) {
-      printf("\"status\":\"error\",\"message\":\"login failed\",");
-      printf("\"response\":\"%s\"}\n", ftp_last_response(&session));
+      fprintf(info, "{\"action\":\"mode\",\"status\":\"error\",");
+      fprintf(info, "\"response\":\"%s\"}\n", ftp_last_response(&session));
     } else {
-      fprintf(stderr, "ftp: login failed: %s\n", ftp_last_response(&session));
+      fprintf(stderr, "ftp: MODE Z refused, transferring uncompressed: %s\n",
+              ftp_last_response(&session));
     }
-    ftp_close(&session);
-    return 1;
   }
 
-  if (json_output) {
-    printf("\"status\":\"ok\",\"response\":\"%s\"}\n",
-           ftp_last_response(&session));
+  /* Run the command or the script, or enter interactive mode */
+  int result;
+  if (command_argv) {
+    result = ftp_run_one(&session, command_argc, command_argv, json_output);
+    free(command_argv);
+  } else if (script) {
+    result = ftp_batch(&session, script, json_output);
   } else {
-    printf("Logged in: %s\n", ftp_last_response(&session));
+    result = ftp_interactive(&session, json_output);
   }
+  close_script(script);
 
-  /* Enter interactive mode */
-  int result = ftp_interactive(&session, json_output);
-
-  /* Disconnect */
-  ftp_quit(&session);
+  /* Disconnect, or leave the session for the next command */
+  if (keep == 0 || ftp_pool_give(&session, home, keep) < 0) {
+    ftp_quit(&session);
+  }
 
   return result;
 }
@@ -218,10 +420,17 @@ static int ftp_run(int argc, char **argv) {
 const jshell_cmd_spec_t cmd_ftp_spec = {
   .name = "ftp",
   .summary = "FTP client for file transfer",
-  .long_help = "Connect to an FTP server for file upload and download.",
+  .long_help = "Connect to an FTP server for file upload and download. "
+               "A command given after the options runs alone; "
+               "'get FILE -' streams FILE to stdout and 'put - FILE' "
+               "uploads stdin, for use in pipelines. "
+               "'mirror REMOTE LOCAL' (or -R to upload) moves only the "
+               "files that differ between two trees. "
+               "--compress deflates transfers on the wire (MODE Z).",
   .type = CMD_EXTERNAL,
   .run = ftp_run,
   .print_usage = ftp_print_usage,
+  .describe_args = ftp_describe_args,
 };
 
 
@@ -4,11 +4,22 @@
  *
  * This module implements the core FTP client functionality including
  * connection management, data transfers, and command execution.
+ *
+ * Over TLS the sockets stay blocking, so OpenSSL's reads and writes
+ * stand in for recv() and send() one for one. A callback keeps the
+ * newest session the server issues, on the control connection or a data
+ * one, and the next data connection resumes it.
+ *
+ * Transfers to or from a pipe (get to "-", put from "-") move the data
+ * with splice(), so it never passes through user space.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -19,53 +30,306 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#include <zlib.h>
 
 #include "ftp_client.h"
+#include "utils/jbox_gzip.h"
+
+
+/** Buffer size for ranged downloads. */
+#define FTP_RANGE_BUFFER (256 * 1024)
+
+/** Bytes asked of each SSL_sendfile() call. */
+#define FTP_SENDFILE_CHUNK (1024 * 1024)
+
+/** Smallest upload announced to the server with ALLO. */
+#define FTP_ALLO_MIN (1024 * 1024)
+
+/** Bytes asked of each splice() call. */
+#define FTP_SPLICE_CHUNK (1024 * 1024)
+
+/** Buffer size for deflated data, each way. */
+#define FTP_ZLIB_BUFFER (64 * 1024)
+
+
+/**
+ * @brief A data connection being read, inflated in MODE Z.
+ */
+typedef struct {
+  ftp_session_t *session;             /**< Session owning the connection. */
+  int fd;                             /**< Data connection. */
+  z_stream *z;                        /**< Inflater, or NULL if the data is
+                                           not deflated. */
+  unsigned char *in;                  /**< Deflated bytes read ahead. */
+  bool ended;                         /**< Whether the stream has ended. */
+} data_reader_t;
+
+
+/**
+ * @brief A data connection a deflater writes to.
+ */
+typedef struct {
+  ftp_session_t *session;             /**< Session owning the connection. */
+  int fd;                             /**< Data connection. */
+} data_sink_t;
 
 
 /**
- * @brief Read a response line from the control connection.
+ * @brief Turn a failed TLS read or write into errno.
  *
- * @param session Pointer to session.
- * @return Response code, or -1 on error.
+ * @param ssl Connection.
+ * @param rc What the call returned.
+ * @return 0 for the peer's close_notify, -1 otherwise.
  */
-static int read_response(ftp_session_t *session) {
-  if (!session || session->ctrl_fd < 0) {
-    return -1;
+static ssize_t tls_error(SSL *ssl, int rc) {
+  switch (SSL_get_error(ssl, rc)) {
+    case SSL_ERROR_ZERO_RETURN:
+      return 0;
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+      /* A blocking socket only wants more after a signal */
+      errno = EINTR;
+      return -1;
+    case SSL_ERROR_SYSCALL:
+      if (errno == 0) errno = EIO;
+      break;
+    default:
+      errno = EIO;
+      break;
   }
 
-  char *buf = session->last_response;
-  size_t bufsize = sizeof(session->last_response);
-  size_t pos = 0;
+  /* After a fatal error no close_notify may be sent */
+  SSL_set_quiet_shutdown(ssl, 1);
+  ERR_clear_error();
+  return -1;
+}
 
-  while (pos < bufsize - 1) {
-    char c;
-    ssize_t n = recv(session->ctrl_fd, &c, 1, 0);
 
-    if (n < 0) {
-      if (errno == EINTR) continue;
+/**
+ * @brief Read from a connection, through TLS if it has it.
+ *
+ * @param ssl TLS of the connection, or NULL.
+ * @param fd Socket.
+ * @param buf Buffer for the data.
+ * @param len Size of buf.
+ * @return Bytes read, 0 at the end, or -1 with errno set.
+ */
+static ssize_t conn_read(SSL *ssl, int fd, void *buf, size_t len) {
+  if (!ssl) return recv(fd, buf, len, 0);
+
+  ERR_clear_error();
+  errno = 0;
+  size_t n;
+  int rc = SSL_read_ex(ssl, buf, len, &n);
+  return rc == 1 ? (ssize_t)n : tls_error(ssl, rc);
+}
+
+
+/**
+ * @brief Write to a connection, through TLS if it has it.
+ *
+ * @param ssl TLS of the connection, or NULL.
+ * @param fd Socket.
+ * @param buf Data to write.
+ * @param len Length of data.
+ * @return Bytes written, or -1 with errno set.
+ */
+static ssize_t conn_write(SSL *ssl, int fd, const void *buf, size_t len) {
+  if (!ssl) return send(fd, buf, len, 0);
+
+  ERR_clear_error();
+  errno = 0;
+  size_t n;
+  int rc = SSL_write_ex(ssl, buf, len, &n);
+  return rc == 1 ? (ssize_t)n : tls_error(ssl, rc);
+}
+
+
+/**
+ * @brief Keep the newest session the server issues; OpenSSL callback.
+ *
+ * @param ssl Connection the session came on.
+ * @param tls_session New session.
+ * @return 1, as the session is kept.
+ */
+static int keep_session(SSL *ssl, SSL_SESSION *tls_session) {
+  ftp_session_t *session = SSL_get_app_data(ssl);
+  SSL_SESSION_free(session->tls_session);
+  session->tls_session = tls_session;
+  return 1;
+}
+
+
+/**
+ * @brief Create the session's TLS context, if it has none yet.
+ *
+ * @param session Pointer to session.
+ * @return 0 on success, -1 on error.
+ */
+static int create_tls_context(ftp_session_t *session) {
+  if (session->tls_ctx) return 0;
+
+  SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+  if (!ctx) return -1;
+
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+  SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT |
+                                      SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb(ctx, keep_session);
+
+  if (session->tls_verify) {
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+    int loaded = session->tls_ca[0]
+                 ? SSL_CTX_load_verify_locations(ctx, session->tls_ca, NULL)
+                 : SSL_CTX_set_default_verify_paths(ctx);
+    if (loaded != 1) {
+      snprintf(session->last_response, sizeof(session->last_response),
+               "cannot load certificate authorities%s%.400s",
+               session->tls_ca[0] ? " from " : "", session->tls_ca);
+      SSL_CTX_free(ctx);
+      ERR_clear_error();
       return -1;
     }
+  }
+
+  session->tls_ctx = ctx;
+  return 0;
+}
+
+
+/**
+ * @brief Do the client side of a handshake on a connection.
+ *
+ * @param session Pointer to session with a TLS context.
+ * @param fd Connected socket.
+ * @param resume Session to resume, or NULL.
+ * @return Connection, or NULL with last_response set.
+ */
+static SSL *start_tls(ftp_session_t *session, int fd, SSL_SESSION *resume) {
+  ERR_clear_error();
+  SSL *ssl = SSL_new(session->tls_ctx);
+  if (!ssl) return NULL;
+  SSL_set_app_data(ssl, session);
+
+  /* An address is checked against the certificate's, a name by SNI */
+  struct in_addr addr;
+  bool numeric = inet_pton(AF_INET, session->host, &addr) == 1;
+  int ok = SSL_set_fd(ssl, fd);
+  if (ok == 1 && !numeric) {
+    ok = SSL_set_tlsext_host_name(ssl, session->host);
+  }
+  if (ok == 1 && session->tls_verify) {
+    ok = numeric
+         ? X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), session->host)
+         : SSL_set1_host(ssl, session->host);
+  }
+  if (ok == 1 && resume) {
+    ok = SSL_set_session(ssl, resume);
+  }
+  if (ok == 1) {
+    ok = SSL_connect(ssl);
+  }
+
+  if (ok != 1) {
+    long verify = SSL_get_verify_result(ssl);
+    snprintf(session->last_response, sizeof(session->last_response),
+             "TLS handshake failed%s%s",
+             verify != X509_V_OK ? ": " : "",
+             verify != X509_V_OK ? X509_verify_cert_error_string(verify) : "");
+    SSL_set_quiet_shutdown(ssl, 1);
+    SSL_free(ssl);
+    ERR_clear_error();
+    return NULL;
+  }
+  return ssl;
+}
+
+
+/**
+ * @brief Read a byte of control input, refilling the buffer as needed.
+ *
+ * @param session Pointer to session.
+ * @param c Set to the byte.
+ * @return 1 on success, 0 at end of file, -1 on error.
+ */
+static int read_byte(ftp_session_t *session, char *c) {
+  if (session->ctrl_pos == session->ctrl_len) {
+    ssize_t n;
+    do {
+      n = conn_read(session->ctrl_tls, session->ctrl_fd, session->ctrl_buf,
+                    sizeof(session->ctrl_buf));
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) return (int)n;
+    session->ctrl_len = (size_t)n;
+    session->ctrl_pos = 0;
+  }
+
+  *c = session->ctrl_buf[session->ctrl_pos++];
+  return 1;
+}
+
+
+/**
+ * @brief Read a line from the control connection, without its CRLF.
+ *
+ * A line too long for buf is cut short and the rest discarded.
+ *
+ * @param session Pointer to session.
+ * @param buf Buffer for the line.
+ * @param bufsize Size of buf.
+ * @return Length of the line, or -1 on error.
+ */
+static ssize_t read_line(ftp_session_t *session, char *buf, size_t bufsize) {
+  size_t pos = 0;
+  for (;;) {
+    char c;
+    int n = read_byte(session, &c);
+    if (n < 0) return -1;
     if (n == 0) {
       /* Connection closed */
       if (pos > 0) break;
       return -1;
     }
-
-    if (c == '\n') {
-      if (pos > 0 && buf[pos - 1] == '\r') {
-        pos--;
-      }
-      break;
+    if (c == '\n') break;
+    if (pos < bufsize - 1) {
+      buf[pos++] = c;
     }
-
-    buf[pos++] = c;
   }
 
+  if (pos > 0 && buf[pos - 1] == '\r') {
+    pos--;
+  }
   buf[pos] = '\0';
+  return (ssize_t)pos;
+}
+
+
+/**
+ * @brief Read a response from the control connection.
+ *
+ * Of a multi-line response ("123-" up to "123 "), last_response keeps
+ * the first line.
+ *
+ * @param session Pointer to session.
+ * @return Response code, or -1 on error.
+ */
+static int read_response(ftp_session_t *session) {
+  if (!session || session->ctrl_fd < 0) {
+    return -1;
+  }
+
+  char *buf = session->last_response;
+  ssize_t len = read_line(session, buf, sizeof(session->last_response));
+  if (len < 0) {
+    return -1;
+  }
 
   /* Parse response code */
-  if (pos >= 3 && isdigit((unsigned char)buf[0]) &&
+  if (len >= 3 && isdigit((unsigned char)buf[0]) &&
       isdigit((unsigned char)buf[1]) && isdigit((unsigned char)buf[2])) {
     session->last_code = (buf[0] - '0') * 100 +
                          (buf[1] - '0') * 10 +
@@ -74,10 +338,41 @@ static int read_response(ftp_session_t *session) {
     session->last_code = -1;
   }
 
+  if (session->last_code >= 0 && buf[3] == '-') {
+    char line[FTP_RESPONSE_MAX];
+    do {
+      if (read_line(session, line, sizeof(line)) < 0) return -1;
+    } while (strncmp(line, buf, 3) != 0 || line[3] != ' ');
+  }
+
   return session->last_code;
 }
 
 
+/**
+ * @brief Write all of a buffer to the control connection.
+ *
+ * @param session Pointer to session.
+ * @param buf Data to write.
+ * @param len Length of data.
+ * @return 0 on success, -1 on error.
+ */
+static int write_control(ftp_session_t *session, const char *buf,
+                         size_t len) {
+  size_t sent = 0;
+  while (sent < len) {
+    ssize_t n = conn_write(session->ctrl_tls, session->ctrl_fd, buf + sent,
+                           len - sent);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    sent += (size_t)n;
+  }
+  return 0;
+}
+
+
 /**
  * @brief Send a command to the server.
  *
@@ -99,28 +394,17 @@ static int send_command(ftp_session_t *session, const char *cmd) {
   buf[len + 1] = '\n';
   buf[len + 2] = '\0';
 
-  size_t total = len + 2;
-  size_t sent = 0;
-
-  while (sent < total) {
-    ssize_t n = send(session->ctrl_fd, buf + sent, total - sent, 0);
-    if (n < 0) {
-      if (errno == EINTR) continue;
-      free(buf);
-      return -1;
-    }
-    sent += (size_t)n;
-  }
-
+  int result = write_control(session, buf, len + 2);
   free(buf);
-  return 0;
+  return result;
 }
 
 
 /**
  * @brief Set up a listening socket for data connection.
  *
- * Binds to an ephemeral port and starts listening.
+ * Binds an ephemeral port on the address the control connection
+ * uses, which the server can reach, and starts listening.
  *
  * @param session Pointer to session.
  * @return 0 on success, -1 on error.
@@ -134,6 +418,15 @@ static int setup_data_listener(ftp_session_t *session) {
     session->data_listen_fd = -1;
   }
 
+  /* Listen on the local end of the control connection */
+  struct sockaddr_in addr;
+  socklen_t addrlen = sizeof(addr);
+  if (getsockname(session->ctrl_fd, (struct sockaddr *)&addr,
+                  &addrlen) < 0) {
+    return -1;
+  }
+  addr.sin_port = 0;
+
   /* Create socket */
   int sock = socket(AF_INET, SOCK_STREAM, 0);
   if (sock < 0) return -1;
@@ -142,20 +435,13 @@ static int setup_data_listener(ftp_session_t *session) {
   int optval = 1;
   setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
 
-  /* Bind to ephemeral port */
-  struct sockaddr_in addr = {
-    .sin_family = AF_INET,
-    .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
-    .sin_port = 0
-  };
-
   if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
     close(sock);
     return -1;
   }
 
   /* Get assigned port */
-  socklen_t addrlen = sizeof(addr);
+  addrlen = sizeof(addr);
   if (getsockname(sock, (struct sockaddr *)&addr, &addrlen) < 0) {
     close(sock);
     return -1;
@@ -183,9 +469,18 @@ static int setup_data_listener(ftp_session_t *session) {
 static int send_port_command(ftp_session_t *session) {
   if (!session || session->data_port == 0) return -1;
 
+  struct sockaddr_in addr;
+  socklen_t addrlen = sizeof(addr);
+  if (getsockname(session->data_listen_fd, (struct sockaddr *)&addr,
+                  &addrlen) < 0) {
+    return -1;
+  }
+
   char cmd[64];
+  uint32_t ip = ntohl(addr.sin_addr.s_addr);
   uint16_t port = session->data_port;
-  snprintf(cmd, sizeof(cmd), "PORT 127,0,0,1,%u,%u",
+  snprintf(cmd, sizeof(cmd), "PORT %u,%u,%u,%u,%u,%u",
+           (ip >> 24) & 0xFF, (ip >> 16) & 0xFF, (ip >> 8) & 0xFF, ip & 0xFF,
            (port >> 8) & 0xFF, port & 0xFF);
 
   if (send_command(session, cmd) < 0) return -1;
@@ -196,35 +491,303 @@ static int send_port_command(ftp_session_t *session) {
 
 
 /**
- * @brief Accept incoming data connection.
+ * @brief Ask the server for a passive data port.
  *
- * @param session Pointer to session with data_listen_fd set.
- * @return Data socket fd, or -1 on error.
+ * Tries EPSV, then PASV. Only the port of a PASV reply is used; the
+ * address is the server's own, as in the EPSV case, since a server
+ * behind NAT often gives one the client cannot reach.
+ *
+ * @param session Pointer to session.
+ * @param port Set to the server's data port.
+ * @return 0 on success, 1 if the server knows neither command, -1 on
+ *         error.
  */
-static int accept_data_connection(ftp_session_t *session) {
-  if (!session || session->data_listen_fd < 0) return -1;
+static int request_passive_port(ftp_session_t *session, uint16_t *port) {
+  if (send_command(session, "EPSV") < 0) return -1;
+  int code = read_response(session);
+
+  if (code == 229) {
+    /* 229 Entering Extended Passive Mode (|||port|) */
+    const char *p = strchr(session->last_response, '(');
+    unsigned int value;
+    char delim;
+    if (!p || sscanf(p + 1, "%c%*c%*c%u", &delim, &value) != 2 ||
+        value == 0 || value > 65535) {
+      return -1;
+    }
+    *port = (uint16_t)value;
+    return 0;
+  }
+  if (code != 500 && code != 502) return -1;
 
+  if (send_command(session, "PASV") < 0) return -1;
+  code = read_response(session);
+  if (code == 500 || code == 502) return 1;
+  if (code != 227) return -1;
+
+  /* 227 Entering Passive Mode (h1,h2,h3,h4,p1,p2) */
+  const char *p = strchr(session->last_response, '(');
+  unsigned int h1, h2, h3, h4, p1, p2;
+  if (!p || sscanf(p + 1, "%u,%u,%u,%u,%u,%u",
+                   &h1, &h2, &h3, &h4, &p1, &p2) != 6 ||
+      p1 > 255 || p2 > 255) {
+    return -1;
+  }
+  *port = (uint16_t)((p1 << 8) | p2);
+  return 0;
+}
+
+
+/**
+ * @brief Connect to a passive data port of the server.
+ *
+ * @param session Pointer to session.
+ * @param port Server's data port.
+ * @return 0 on success, -1 on error.
+ */
+static int connect_passive(ftp_session_t *session, uint16_t port) {
   struct sockaddr_in addr;
   socklen_t addrlen = sizeof(addr);
+  if (getpeername(session->ctrl_fd, (struct sockaddr *)&addr,
+                  &addrlen) < 0) {
+    return -1;
+  }
+  addr.sin_port = htons(port);
 
-  int data_fd = accept(session->data_listen_fd,
-                       (struct sockaddr *)&addr, &addrlen);
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  if (sock < 0) return -1;
 
-  /* Close listener after accepting */
-  close(session->data_listen_fd);
-  session->data_listen_fd = -1;
+  if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(sock);
+    return -1;
+  }
 
+  session->data_fd = sock;
+  return 0;
+}
+
+
+/**
+ * @brief Close a data connection set up but not taken.
+ *
+ * @param session Pointer to session.
+ */
+static void close_data_channel(ftp_session_t *session) {
+  if (session->data_listen_fd >= 0) {
+    close(session->data_listen_fd);
+    session->data_listen_fd = -1;
+  }
+  if (session->data_fd >= 0) {
+    close(session->data_fd);
+    session->data_fd = -1;
+  }
+}
+
+
+/**
+ * @brief Prepare the data connection for the next transfer command.
+ *
+ * In passive mode the connection is made now; in active mode the
+ * client listens and sends PORT.
+ *
+ * @param session Pointer to session.
+ * @return 0 on success, -1 on error.
+ */
+static int open_data_channel(ftp_session_t *session) {
+  close_data_channel(session);
+
+  if (session->passive) {
+    uint16_t port;
+    int rc = request_passive_port(session, &port);
+    if (rc < 0) return -1;
+    if (rc == 0) return connect_passive(session, port);
+    /* The server only knows PORT */
+  }
+
+  if (setup_data_listener(session) < 0) return -1;
+  if (send_port_command(session) < 0) {
+    close_data_channel(session);
+    return -1;
+  }
+  return 0;
+}
+
+
+/**
+ * @brief Take the data connection once the server has replied 150.
+ *
+ * A secured session does the TLS handshake now, resuming the newest
+ * session, and keeps the connection in data_tls.
+ *
+ * @param session Pointer to session with a data channel open.
+ * @return Data socket fd, or -1 on error.
+ */
+static int take_data_connection(ftp_session_t *session) {
+  if (!session) return -1;
+
+  int data_fd = session->data_fd;
+  session->data_fd = -1;
+
+  if (data_fd < 0) {
+    if (session->data_listen_fd < 0) return -1;
+
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+
+    data_fd = accept(session->data_listen_fd,
+                     (struct sockaddr *)&addr, &addrlen);
+
+    /* Close listener after accepting */
+    close(session->data_listen_fd);
+    session->data_listen_fd = -1;
+  }
+
+  if (data_fd >= 0 && session->tls) {
+    session->data_tls = start_tls(session, data_fd, session->tls_session);
+    if (!session->data_tls) {
+      close(data_fd);
+      return -1;
+    }
+  }
   return data_fd;
 }
 
 
+/**
+ * @brief Close a data connection taken with take_data_connection().
+ *
+ * Over TLS, close_notify goes first, which tells the server an upload
+ * is complete rather than cut off.
+ *
+ * @param session Pointer to session.
+ * @param data_fd Data socket.
+ */
+static void close_data_connection(ftp_session_t *session, int data_fd) {
+  if (session->data_tls) {
+    ERR_clear_error();
+    SSL_shutdown(session->data_tls);
+    SSL_free(session->data_tls);
+    session->data_tls = NULL;
+    ERR_clear_error();
+  }
+  close(data_fd);
+}
+
+
+/**
+ * @brief Start reading a data connection, inflating it in MODE Z.
+ *
+ * @param reader Reader to set up.
+ * @param session Session owning the connection.
+ * @param data_fd Data connection.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int reader_open(data_reader_t *reader, ftp_session_t *session,
+                       int data_fd) {
+  *reader = (data_reader_t){ .session = session, .fd = data_fd };
+  if (!session->mode_z) return 0;
+
+  reader->z = calloc(1, sizeof(*reader->z));
+  reader->in = malloc(FTP_ZLIB_BUFFER);
+  if (!reader->z || !reader->in || inflateInit(reader->z) != Z_OK) {
+    free(reader->z);
+    free(reader->in);
+    reader->z = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+
+/**
+ * @brief Read the data of a data connection.
+ *
+ * @param reader Reader.
+ * @param buf Buffer for the data.
+ * @param len Size of buf.
+ * @return Bytes read, 0 at the end, or -1 with errno set; a deflated
+ *         stream cut short is an error (EPROTO).
+ */
+static ssize_t data_read(data_reader_t *reader, void *buf, size_t len) {
+  if (!reader->z) return conn_read(reader->session->data_tls, reader->fd,
+                                   buf, len);
+
+  z_stream *z = reader->z;
+  z->next_out = buf;
+  z->avail_out = (uInt)len;
+  while (z->avail_out == len && !reader->ended) {
+    if (z->avail_in == 0) {
+      ssize_t n = conn_read(reader->session->data_tls, reader->fd,
+                            reader->in, FTP_ZLIB_BUFFER);
+      if (n < 0) return -1;
+      if (n == 0) {
+        errno = EPROTO;
+        return -1;
+      }
+      z->next_in = reader->in;
+      z->avail_in = (uInt)n;
+    }
+    int rc = inflate(z, Z_NO_FLUSH);
+    if (rc == Z_STREAM_END) {
+      reader->ended = true;
+    } else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+      errno = EPROTO;
+      return -1;
+    }
+  }
+  return (ssize_t)(len - z->avail_out);
+}
+
+
+/**
+ * @brief Free what reader_open() allocated.
+ *
+ * @param reader Reader.
+ */
+static void reader_close(data_reader_t *reader) {
+  if (reader->z) {
+    inflateEnd(reader->z);
+    free(reader->z);
+    free(reader->in);
+    reader->z = NULL;
+  }
+}
+
+
+/**
+ * @brief Write all of a buffer to a data connection; a deflater's sink.
+ *
+ * @param ctx The data_sink_t of the connection.
+ * @param data Bytes to write.
+ * @param len Number of bytes.
+ * @return 0 on success, -1 on error.
+ */
+static int write_data(void *ctx, const void *data, size_t len) {
+  data_sink_t *sink = ctx;
+  const char *p = data;
+  while (len > 0) {
+    ssize_t s = conn_write(sink->session->data_tls, sink->fd, p, len);
+    if (s < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    p += s;
+    len -= (size_t)s;
+  }
+  return 0;
+}
+
+
 void ftp_session_init(ftp_session_t *session) {
   if (!session) return;
 
   memset(session, 0, sizeof(*session));
   session->ctrl_fd = -1;
   session->data_listen_fd = -1;
+  session->data_fd = -1;
   session->data_port = 0;
+  session->passive = true;
+  session->tls_verify = true;
   session->last_code = -1;
   session->connected = false;
   session->logged_in = false;
@@ -268,6 +831,8 @@ int ftp_connect(ftp_session_t *session, const char *host, uint16_t port) {
 
   session->ctrl_fd = sock;
   session->connected = true;
+  snprintf(session->host, sizeof(session->host), "%s", host);
+  session->port = port;
 
   /* Read welcome message */
   int code = read_response(session);
@@ -282,6 +847,47 @@ int ftp_connect(ftp_session_t *session, const char *host, uint16_t port) {
 }
 
 
+int ftp_auth_tls(ftp_session_t *session, struct ssl_session_st *resume) {
+  if (!session || !session->connected || session->ctrl_tls) return -1;
+  if (create_tls_context(session) < 0) return -1;
+
+  if (send_command(session, "AUTH TLS") < 0) return -1;
+  if (read_response(session) != 234) return -1;
+  /* Anything sent in the clear after 234 was not sent by the server */
+  session->ctrl_len = session->ctrl_pos = 0;
+
+  session->ctrl_tls = start_tls(session, session->ctrl_fd, resume);
+  if (!session->ctrl_tls) return -1;
+
+  /* TLS needs no protection buffer; PROT P protects the data too */
+  if (send_command(session, "PBSZ 0") < 0 || read_response(session) != 200 ||
+      send_command(session, "PROT P") < 0 || read_response(session) != 200) {
+    return -1;
+  }
+
+  session->tls = true;
+  return 0;
+}
+
+
+struct ssl_session_st *ftp_tls_ticket(ftp_session_t *session) {
+  if (!session || !session->tls_session) return NULL;
+  return SSL_SESSION_up_ref(session->tls_session) == 1
+         ? session->tls_session : NULL;
+}
+
+
+void ftp_tls_ticket_free(struct ssl_session_st *ticket) {
+  SSL_SESSION_free(ticket);
+}
+
+
+const char *ftp_tls_version(ftp_session_t *session) {
+  if (!session || !session->ctrl_tls) return NULL;
+  return SSL_get_version(session->ctrl_tls);
+}
+
+
 int ftp_login(ftp_session_t *session, const char *username) {
   if (!session || !session->connected || !username) return -1;
 
@@ -293,6 +899,7 @@ int ftp_login(ftp_session_t *session, const char *username) {
   int code = read_response(session);
   if (code == 230) {
     session->logged_in = true;
+    snprintf(session->user, sizeof(session->user), "%s", username);
     return 0;
   }
 
@@ -300,107 +907,372 @@ int ftp_login(ftp_session_t *session, const char *username) {
 }
 
 
+int ftp_mode_z(ftp_session_t *session, bool on) {
+  if (!session || !session->logged_in) return -1;
+
+  if (send_command(session, on ? "MODE Z" : "MODE S") < 0) return -1;
+  if (read_response(session) != 200) return -1;
+
+  session->mode_z = on;
+  return 0;
+}
+
+
 int ftp_quit(ftp_session_t *session) {
   if (!session || !session->connected) return -1;
 
   send_command(session, "QUIT");
   read_response(session);
 
-  ftp_close(session);
-  return 0;
+  ftp_close(session);
+  return 0;
+}
+
+
+void ftp_close(ftp_session_t *session) {
+  if (!session) return;
+
+  close_data_channel(session);
+
+  /* The server closes the control connection after QUIT, so a
+     close_notify could only meet a reset */
+  if (session->ctrl_tls) {
+    SSL_set_quiet_shutdown(session->ctrl_tls, 1);
+    SSL_free(session->ctrl_tls);
+    session->ctrl_tls = NULL;
+  }
+  SSL_SESSION_free(session->tls_session);
+  session->tls_session = NULL;
+  SSL_CTX_free(session->tls_ctx);
+  session->tls_ctx = NULL;
+
+  if (session->ctrl_fd >= 0) {
+    close(session->ctrl_fd);
+    session->ctrl_fd = -1;
+  }
+  session->ctrl_len = session->ctrl_pos = 0;
+
+  session->connected = false;
+  session->logged_in = false;
+  session->tls = false;
+  session->mode_z = false;
+}
+
+
+/**
+ * @brief Run a listing command and hand its lines to fn as they arrive.
+ *
+ * @param session Pointer to logged-in session.
+ * @param cmd Command, LIST or MLSD with its argument.
+ * @param fn Called for each line.
+ * @param ctx Passed to fn.
+ * @return 0 on success, -1 on error.
+ */
+static int stream_listing(ftp_session_t *session, const char *cmd,
+                          ftp_line_fn fn, void *ctx) {
+  /* Setup data connection */
+  if (open_data_channel(session) < 0) return -1;
+
+  if (send_command(session, cmd) < 0) {
+    close_data_channel(session);
+    return -1;
+  }
+
+  int code = read_response(session);
+  if (code != 150 && code != 125) {
+    close_data_channel(session);
+    return -1;
+  }
+
+  /* Accept data connection */
+  int data_fd = take_data_connection(session);
+  if (data_fd < 0) return -1;
+
+  data_reader_t reader;
+  char *buf = malloc(FTP_LIST_BUFFER + 1);
+  if (!buf || reader_open(&reader, session, data_fd) < 0) {
+    free(buf);
+    close_data_connection(session, data_fd);
+    read_response(session);
+    return -1;
+  }
+
+  /* Split lines in the buffer, keeping a partial one for the next read */
+  size_t len = 0;
+  bool stopped = false;
+  bool eof = false;
+  int result = 0;
+
+  while (!stopped && !eof) {
+    ssize_t n = data_read(&reader, buf + len, FTP_LIST_BUFFER - len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      result = -1;
+      break;
+    }
+    len += (size_t)n;
+    eof = n == 0;
+
+    char *start = buf;
+    char *end = buf + len;
+    while (!stopped) {
+      char *nl = memchr(start, '\n', (size_t)(end - start));
+      if (!nl) {
+        /* A last line without newline, or one longer than the buffer */
+        if (start == end || (!eof && (start > buf || len < FTP_LIST_BUFFER))) {
+          break;
+        }
+        nl = end;
+      }
+      char *line_end = nl > start && nl[-1] == '\r' ? nl - 1 : nl;
+      *line_end = '\0';
+      stopped = fn(start, ctx) != 0;
+      start = nl < end ? nl + 1 : end;
+    }
+
+    len = (size_t)(end - start);
+    memmove(buf, start, len);
+  }
+
+  reader_close(&reader);
+  free(buf);
+  close_data_connection(session, data_fd);
+
+  /* Read completion response; stopping early may abort the transfer */
+  code = read_response(session);
+  if (code != 226 && !(stopped && code == 426)) result = -1;
+
+  return result;
+}
+
+
+int ftp_list(ftp_session_t *session, const char *path, ftp_line_fn fn,
+             void *ctx) {
+  if (!session || !session->logged_in || !fn) return -1;
+
+  char cmd[512];
+  if (path && path[0]) {
+    snprintf(cmd, sizeof(cmd), "LIST %s", path);
+  } else {
+    strcpy(cmd, "LIST");
+  }
+
+  return stream_listing(session, cmd, fn, ctx);
 }
 
 
-void ftp_close(ftp_session_t *session) {
-  if (!session) return;
+/** Caller of ftp_mlsd(), for parse_facts(). */
+typedef struct {
+  ftp_entry_fn fn;
+  void *ctx;
+} mlsd_ctx_t;
 
-  if (session->data_listen_fd >= 0) {
-    close(session->data_listen_fd);
-    session->data_listen_fd = -1;
-  }
 
-  if (session->ctrl_fd >= 0) {
-    close(session->ctrl_fd);
-    session->ctrl_fd = -1;
+/**
+ * @brief Parse an MLSD line, "fact=value;...; name", and pass it on.
+ *
+ * @param line Line of the listing.
+ * @param ctx The mlsd_ctx_t of the listing.
+ * @return What the caller's function returns; 0 for a line without
+ *         facts, which is skipped.
+ */
+static int parse_facts(const char *line, void *ctx) {
+  mlsd_ctx_t *mlsd = ctx;
+  const char *name = strchr(line, ' ');
+  if (!name) return 0;
+
+  char type[32] = "";
+  char modify[32] = "";
+  ftp_entry_t entry = {
+    .name = name + 1,
+    .type = type,
+    .size = -1,
+    .modify = modify,
+  };
+
+  /* Fact names are case-insensitive; unknown facts are skipped */
+  for (const char *fact = line; fact < name;) {
+    const char *semi = memchr(fact, ';', (size_t)(name - fact));
+    if (!semi) break;
+    const char *eq = memchr(fact, '=', (size_t)(semi - fact));
+    if (eq) {
+      size_t keylen = (size_t)(eq - fact);
+      int vlen = (int)(semi - eq - 1);
+      if (keylen == 4 && strncasecmp(fact, "type", 4) == 0) {
+        snprintf(type, sizeof(type), "%.*s", vlen, eq + 1);
+      } else if (keylen == 4 && strncasecmp(fact, "size", 4) == 0) {
+        entry.size = strtoll(eq + 1, NULL, 10);
+      } else if (keylen == 6 && strncasecmp(fact, "modify", 6) == 0) {
+        snprintf(modify, sizeof(modify), "%.*s", vlen, eq + 1);
+      }
+    }
+    fact = semi + 1;
   }
 
-  session->connected = false;
-  session->logged_in = false;
+  return mlsd->fn(&entry, mlsd->ctx);
 }
 
 
-int ftp_list(ftp_session_t *session, const char *path, char **output) {
-  if (!session || !session->logged_in || !output) return -1;
-
-  *output = NULL;
-
-  /* Setup data connection */
-  if (setup_data_listener(session) < 0) return -1;
-  if (send_port_command(session) < 0) return -1;
+int ftp_mlsd(ftp_session_t *session, const char *path, ftp_entry_fn fn,
+             void *ctx) {
+  if (!session || !session->logged_in || !fn) return -1;
 
-  /* Send LIST command */
   char cmd[512];
   if (path && path[0]) {
-    snprintf(cmd, sizeof(cmd), "LIST %s", path);
+    snprintf(cmd, sizeof(cmd), "MLSD %s", path);
   } else {
-    strcpy(cmd, "LIST");
+    strcpy(cmd, "MLSD");
   }
 
-  if (send_command(session, cmd) < 0) return -1;
+  mlsd_ctx_t mlsd = { fn, ctx };
+  return stream_listing(session, cmd, parse_facts, &mlsd);
+}
 
-  int code = read_response(session);
-  if (code != 150 && code != 125) {
-    if (session->data_listen_fd >= 0) {
-      close(session->data_listen_fd);
-      session->data_listen_fd = -1;
+
+/**
+ * @brief Copy what arrives on a data connection to a descriptor.
+ *
+ * Into a pipe, and without TLS or MODE Z, splice() moves each block
+ * from the socket as it arrives, so a reader at the other end starts
+ * at once and no byte is copied through user space. Anything else is
+ * read, inflated in MODE Z, and written.
+ *
+ * @param session Session owning the data connection.
+ * @param data_fd Data connection.
+ * @param out_fd Descriptor to write to.
+ * @return 0 once the server closes the connection, -1 on error.
+ */
+static int copy_from_data(ftp_session_t *session, int data_fd, int out_fd) {
+  if (!session->data_tls && !session->mode_z) {
+    ssize_t n;
+    while ((n = splice(data_fd, NULL, out_fd, NULL, FTP_SPLICE_CHUNK,
+                       SPLICE_F_MOVE | SPLICE_F_MORE)) != 0) {
+      if (n < 0 && errno != EINTR) break;
     }
-    return -1;
+    if (n == 0) return 0;
+    /* EINVAL: out_fd is not a pipe, and nothing was moved yet */
+    if (errno != EINVAL) return -1;
   }
 
-  /* Accept data connection */
-  int data_fd = accept_data_connection(session);
-  if (data_fd < 0) return -1;
+  data_reader_t reader;
+  if (reader_open(&reader, session, data_fd) < 0) return -1;
 
-  /* Read listing */
-  size_t capacity = 4096;
-  size_t len = 0;
-  char *buf = malloc(capacity);
-  if (!buf) {
-    close(data_fd);
-    return -1;
+  char buf[FTP_BUFFER_SIZE];
+  ssize_t n;
+  while ((n = data_read(&reader, buf, sizeof(buf))) > 0) {
+    ssize_t written = 0;
+    while (written < n) {
+      ssize_t w = write(out_fd, buf + written, (size_t)(n - written));
+      if (w < 0) {
+        if (errno == EINTR) continue;
+        reader_close(&reader);
+        return -1;
+      }
+      written += w;
+    }
+  }
+  reader_close(&reader);
+  return n < 0 ? -1 : 0;
+}
+
+
+/**
+ * @brief Send everything a descriptor yields over a data connection.
+ *
+ * From a pipe, and without TLS, splice() hands the data straight to the
+ * socket; anything else is read and written.
+ *
+ * @param session Session owning the data connection.
+ * @param in_fd Descriptor to read until its end.
+ * @param data_fd Data connection.
+ * @return 0 on success, -1 on error.
+ */
+static int copy_to_data(ftp_session_t *session, int in_fd, int data_fd) {
+  if (!session->data_tls) {
+    ssize_t n;
+    while ((n = splice(in_fd, NULL, data_fd, NULL, FTP_SPLICE_CHUNK,
+                       SPLICE_F_MOVE | SPLICE_F_MORE)) != 0) {
+      if (n < 0 && errno != EINTR) break;
+    }
+    if (n == 0) return 0;
+    /* EINVAL: in_fd is not a pipe, and nothing was moved yet */
+    if (errno != EINVAL) return -1;
   }
 
+  char buf[FTP_BUFFER_SIZE];
   ssize_t n;
-  while ((n = recv(data_fd, buf + len, capacity - len - 1, 0)) > 0) {
-    len += (size_t)n;
-    if (len >= capacity - 1) {
-      capacity *= 2;
-      char *newbuf = realloc(buf, capacity);
-      if (!newbuf) {
-        free(buf);
-        close(data_fd);
+  while ((n = read(in_fd, buf, sizeof(buf))) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    ssize_t sent = 0;
+    while (sent < n) {
+      ssize_t s = conn_write(session->data_tls, data_fd, buf + sent,
+                             (size_t)(n - sent));
+      if (s < 0) {
+        if (errno == EINTR) continue;
         return -1;
       }
-      buf = newbuf;
+      sent += s;
     }
   }
+  return 0;
+}
 
-  buf[len] = '\0';
-  close(data_fd);
 
-  /* Read completion response */
-  code = read_response(session);
-  if (code != 226) {
+/**
+ * @brief Deflate everything a descriptor yields onto a data connection,
+ *        for MODE Z.
+ *
+ * A file whose name says it is compressed already goes in stored
+ * blocks, which cost next to nothing to make; a large one is deflated
+ * on several threads.
+ *
+ * @param session Session owning the data connection.
+ * @param in_fd Descriptor to read until its end.
+ * @param data_fd Data connection.
+ * @param name Name of what is sent, for its extension.
+ * @param size Bytes to send, or 0 if unknown.
+ * @return 0 on success, -1 on error.
+ */
+static int send_deflated(ftp_session_t *session, int in_fd, int data_fd,
+                         const char *name, off_t size) {
+  int level = jbox_gzip_compressed_name(name) ? 0 : FTP_ZLIB_LEVEL;
+  int threads = level > 0 && size >= FTP_ZLIB_PARALLEL ? FTP_ZLIB_THREADS
+                                                       : 1;
+  data_sink_t sink = { session, data_fd };
+  jbox_gzip_writer_t *z = jbox_gzip_zlib_writer_new(write_data, &sink,
+                                                    level, threads);
+  char *buf = malloc(FTP_ZLIB_BUFFER);
+  if (!z || !buf) {
+    jbox_gzip_writer_close(z, false);
     free(buf);
     return -1;
   }
 
-  *output = buf;
-  return 0;
+  int result = 0;
+  ssize_t n;
+  while ((n = read(in_fd, buf, FTP_ZLIB_BUFFER)) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      result = -1;
+      break;
+    }
+    if (jbox_gzip_write(z, buf, (size_t)n) < 0) {
+      result = -1;
+      break;
+    }
+  }
+
+  free(buf);
+  if (jbox_gzip_writer_close(z, result == 0) < 0) result = -1;
+  return result;
 }
 
 
-int ftp_get(ftp_session_t *session, const char *remote, const char *local) {
+int ftp_get(ftp_session_t *session, const char *remote, const char *local,
+            bool resume) {
   if (!session || !session->logged_in || !remote) return -1;
 
   /* Determine local filename */
@@ -409,60 +1281,63 @@ int ftp_get(ftp_session_t *session, const char *remote, const char *local) {
     localname = strrchr(remote, '/');
     localname = localname ? localname + 1 : remote;
   }
+  bool to_stdout = strcmp(localname, FTP_STDIO) == 0;
+
+  /* Resume after what is already here */
+  off_t offset = 0;
+  struct stat st;
+  if (resume && !to_stdout && stat(localname, &st) == 0 &&
+      S_ISREG(st.st_mode)) {
+    offset = st.st_size;
+  }
 
   /* Setup data connection */
-  if (setup_data_listener(session) < 0) return -1;
-  if (send_port_command(session) < 0) return -1;
+  if (open_data_channel(session) < 0) return -1;
+
+  if (offset > 0) {
+    char rest[64];
+    snprintf(rest, sizeof(rest), "REST %lld", (long long)offset);
+    if (send_command(session, rest) < 0 || read_response(session) != 350) {
+      close_data_channel(session);
+      return -1;
+    }
+  }
 
   /* Send RETR command */
   char cmd[512];
   snprintf(cmd, sizeof(cmd), "RETR %s", remote);
 
-  if (send_command(session, cmd) < 0) return -1;
+  if (send_command(session, cmd) < 0) {
+    close_data_channel(session);
+    return -1;
+  }
 
   int code = read_response(session);
   if (code != 150 && code != 125) {
-    if (session->data_listen_fd >= 0) {
-      close(session->data_listen_fd);
-      session->data_listen_fd = -1;
-    }
+    close_data_channel(session);
     return -1;
   }
 
   /* Accept data connection */
-  int data_fd = accept_data_connection(session);
+  int data_fd = take_data_connection(session);
   if (data_fd < 0) return -1;
 
-  /* Open local file */
-  int file_fd = open(localname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-  if (file_fd < 0) {
-    close(data_fd);
+  /* Open local file, or stdout */
+  int file_fd = to_stdout
+                ? dup(STDOUT_FILENO)
+                : open(localname,
+                       O_WRONLY | O_CREAT | (offset > 0 ? 0 : O_TRUNC), 0644);
+  if (file_fd < 0 || (offset > 0 && lseek(file_fd, offset, SEEK_SET) < 0)) {
+    if (file_fd >= 0) close(file_fd);
+    close_data_connection(session, data_fd);
     return -1;
   }
 
   /* Receive and write data */
-  char buf[FTP_BUFFER_SIZE];
-  ssize_t n;
-  int result = 0;
-
-  while ((n = recv(data_fd, buf, sizeof(buf), 0)) > 0) {
-    ssize_t written = 0;
-    while (written < n) {
-      ssize_t w = write(file_fd, buf + written, (size_t)(n - written));
-      if (w < 0) {
-        if (errno == EINTR) continue;
-        result = -1;
-        goto done;
-      }
-      written += w;
-    }
-  }
+  int result = copy_from_data(session, data_fd, file_fd);
 
-  if (n < 0) result = -1;
-
-done:
   close(file_fd);
-  close(data_fd);
+  close_data_connection(session, data_fd);
 
   /* Read completion response */
   code = read_response(session);
@@ -472,7 +1347,8 @@ done:
 }
 
 
-int ftp_put(ftp_session_t *session, const char *local, const char *remote) {
+int ftp_put(ftp_session_t *session, const char *local, const char *remote,
+            bool append) {
   if (!session || !session->logged_in || !local) return -1;
 
   /* Determine remote filename */
@@ -482,41 +1358,80 @@ int ftp_put(ftp_session_t *session, const char *local, const char *remote) {
     remotename = remotename ? remotename + 1 : local;
   }
 
-  /* Open local file */
-  int file_fd = open(local, O_RDONLY);
+  /* Standard input has no size to resume from or reserve */
+  bool from_stdin = strcmp(local, FTP_STDIO) == 0;
+  if (from_stdin && (append || !remote || !remote[0])) {
+    snprintf(session->last_response, sizeof(session->last_response),
+             append ? "cannot append from standard input"
+                    : "remote name required for standard input");
+    return -1;
+  }
+
+  /* Open local file, or stdin */
+  int file_fd = from_stdin ? dup(STDIN_FILENO) : open(local, O_RDONLY);
   if (file_fd < 0) return -1;
 
-  /* Setup data connection */
-  if (setup_data_listener(session) < 0) {
+  /* Send only what the server does not have yet */
+  off_t offset = 0;
+  if (append && ftp_size(session, remotename, &offset) < 0) {
+    offset = 0;
+  }
+  struct stat st;
+  if (fstat(file_fd, &st) < 0) {
     close(file_fd);
     return -1;
   }
-  if (send_port_command(session) < 0) {
+  if (from_stdin) {
+    st.st_size = 0;
+  }
+  if (offset > st.st_size) {
+    snprintf(session->last_response, sizeof(session->last_response),
+             "remote file is larger than local file");
+    close(file_fd);
+    return -1;
+  }
+  if (offset > 0 && lseek(file_fd, offset, SEEK_SET) < 0) {
+    close(file_fd);
+    return -1;
+  }
+
+  /* Let the server reserve the space; one that cannot just says so */
+  if (st.st_size - offset >= FTP_ALLO_MIN) {
+    char allo[64];
+    snprintf(allo, sizeof(allo), "ALLO %lld",
+             (long long)(st.st_size - offset));
+    if (send_command(session, allo) < 0 || read_response(session) < 0) {
+      close(file_fd);
+      return -1;
+    }
+  }
+
+  /* Setup data connection */
+  if (open_data_channel(session) < 0) {
     close(file_fd);
     return -1;
   }
 
-  /* Send STOR command */
+  /* Send STOR command, or APPE to add to the remote file */
   char cmd[512];
-  snprintf(cmd, sizeof(cmd), "STOR %s", remotename);
+  snprintf(cmd, sizeof(cmd), "%s %s", offset > 0 ? "APPE" : "STOR",
+           remotename);
 
   if (send_command(session, cmd) < 0) {
     close(file_fd);
+    close_data_channel(session);
     return -1;
   }
 
   int code = read_response(session);
   if (code != 150 && code != 125) {
     close(file_fd);
-    if (session->data_listen_fd >= 0) {
-      close(session->data_listen_fd);
-      session->data_listen_fd = -1;
-    }
+    close_data_channel(session);
     return -1;
   }
 
   /* Accept data connection */
-  int data_fd = accept_data_connection(session);
+  int data_fd = take_data_connection(session);
   if (data_fd < 0) {
     close(file_fd);
     return -1;
@@ -527,10 +1442,35 @@ int ftp_put(ftp_session_t *session, const char *local, const char *remote) {
   ssize_t n;
   int result = 0;
 
+  if (session->mode_z) {
+    result = send_deflated(session, file_fd, data_fd,
+                           from_stdin ? remotename : local,
+                           st.st_size - offset);
+    goto done;
+  }
+
+  if (from_stdin) {
+    result = copy_to_data(session, file_fd, data_fd);
+    goto done;
+  }
+
+  /* Over kernel TLS the kernel encrypts what sendfile() sends */
+  if (session->data_tls &&
+      BIO_get_ktls_send(SSL_get_wbio(session->data_tls))) {
+    ossl_ssize_t s;
+    while ((s = SSL_sendfile(session->data_tls, file_fd, offset,
+                             FTP_SENDFILE_CHUNK, 0)) > 0) {
+      offset += s;
+    }
+    if (s < 0) result = -1;
+    goto done;
+  }
+
   while ((n = read(file_fd, buf, sizeof(buf))) > 0) {
     ssize_t sent = 0;
     while (sent < n) {
-      ssize_t s = send(data_fd, buf + sent, (size_t)(n - sent), 0);
+      ssize_t s = conn_write(session->data_tls, data_fd, buf + sent,
+                             (size_t)(n - sent));
       if (s < 0) {
         if (errno == EINTR) continue;
         result = -1;
@@ -544,7 +1484,7 @@ int ftp_put(ftp_session_t *session, const char *local, const char *remote) {
 
 done:
   close(file_fd);
-  close(data_fd);
+  close_data_connection(session, data_fd);
 
   /* Read completion response */
   code = read_response(session);
@@ -554,6 +1494,100 @@ done:
 }
 
 
+int ftp_get_range(ftp_session_t *session, const char *remote, int fd,
+                  off_t offset, off_t length) {
+  if (!session || !session->logged_in || !remote || fd < 0) return -1;
+
+  if (open_data_channel(session) < 0) return -1;
+
+  char cmd[512];
+  if (offset > 0) {
+    snprintf(cmd, sizeof(cmd), "REST %lld", (long long)offset);
+    if (send_command(session, cmd) < 0 || read_response(session) != 350) {
+      close_data_channel(session);
+      return -1;
+    }
+  }
+
+  snprintf(cmd, sizeof(cmd), "RETR %s", remote);
+  if (send_command(session, cmd) < 0) {
+    close_data_channel(session);
+    return -1;
+  }
+
+  int code = read_response(session);
+  if (code != 150 && code != 125) {
+    close_data_channel(session);
+    return -1;
+  }
+
+  int data_fd = take_data_connection(session);
+  if (data_fd < 0) return -1;
+
+  data_reader_t reader = {0};
+  char *buf = malloc(FTP_RANGE_BUFFER);
+  off_t pos = offset;
+  off_t end = offset + length;
+  int result = buf && reader_open(&reader, session, data_fd) == 0 ? 0 : -1;
+
+  /* Stop at the end of the range, not of the file */
+  while (result == 0 && pos < end) {
+    size_t want = FTP_RANGE_BUFFER;
+    if ((off_t)want > end - pos) want = (size_t)(end - pos);
+
+    ssize_t n = data_read(&reader, buf, want);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      result = -1;
+      break;
+    }
+    if (n == 0) break;
+
+    for (ssize_t written = 0; written < n;) {
+      ssize_t w = pwrite(fd, buf + written, (size_t)(n - written),
+                         pos + written);
+      if (w < 0) {
+        if (errno == EINTR) continue;
+        result = -1;
+        break;
+      }
+      written += w;
+    }
+    pos += n;
+  }
+
+  reader_close(&reader);
+  free(buf);
+  close_data_connection(session, data_fd);
+  if (pos < end) result = -1;
+
+  /* A server still sending when the connection closed reports 426 */
+  code = read_response(session);
+  if (code != 226 && code != 426 && code != 451) result = -1;
+
+  return result;
+}
+
+
+int ftp_size(ftp_session_t *session, const char *remote, off_t *size) {
+  if (!session || !session->logged_in || !remote || !size) return -1;
+
+  char cmd[512];
+  snprintf(cmd, sizeof(cmd), "SIZE %s", remote);
+
+  if (send_command(session, cmd) < 0) return -1;
+  if (read_response(session) != 213) return -1;
+
+  /* 213 <size> */
+  char *end;
+  long long value = strtoll(session->last_response + 3, &end, 10);
+  if (end == session->last_response + 3 || value < 0) return -1;
+
+  *size = (off_t)value;
+  return 0;
+}
+
+
 int ftp_mkdir(ftp_session_t *session, const char *dirname) {
   if (!session || !session->logged_in || !dirname) return -1;
 
@@ -567,6 +1601,55 @@ int ftp_mkdir(ftp_session_t *session, const char *dirname) {
 }
 
 
+int ftp_delete(ftp_session_t *session, const char *remote) {
+  if (!session || !session->logged_in || !remote) return -1;
+
+  char cmd[512];
+  snprintf(cmd, sizeof(cmd), "DELE %s", remote);
+
+  if (send_command(session, cmd) < 0) return -1;
+  return read_response(session) == 250 ? 0 : -1;
+}
+
+
+int ftp_rmdir(ftp_session_t *session, const char *dirname) {
+  if (!session || !session->logged_in || !dirname) return -1;
+
+  char cmd[512];
+  snprintf(cmd, sizeof(cmd), "RMD %s", dirname);
+
+  if (send_command(session, cmd) < 0) return -1;
+  return read_response(session) == 250 ? 0 : -1;
+}
+
+
+int ftp_hash(ftp_session_t *session, const char *remote, char *hex,
+             size_t hexsize) {
+  if (!session || !session->logged_in || !remote || !hex) return -1;
+
+  char cmd[512];
+  snprintf(cmd, sizeof(cmd), "HASH %s", remote);
+
+  if (send_command(session, cmd) < 0) return -1;
+  if (read_response(session) != 213) return -1;
+
+  /* 213 SHA-256 <range> <hex> <name> */
+  char algo[16];
+  char digest[129];
+  if (sscanf(session->last_response + 3, " %15s %*s %128s", algo,
+             digest) != 2 ||
+      strcasecmp(algo, "SHA-256") != 0 || strlen(digest) != 64 ||
+      hexsize <= 64) {
+    return -1;
+  }
+  for (int i = 0; i < 64; i++) {
+    hex[i] = (char)tolower((unsigned char)digest[i]);
+  }
+  hex[64] = '\0';
+  return 0;
+}
+
+
 int ftp_pwd(ftp_session_t *session, char *path, size_t pathsize) {
   if (!session || !session->logged_in || !path || pathsize == 0) return -1;
 
@@ -614,6 +1697,53 @@ int ftp_command(ftp_session_t *session, const char *cmd) {
 }
 
 
+int ftp_pipeline(ftp_session_t *session, const char *const *cmds, int count,
+                 ftp_reply_fn on_reply, void *ctx) {
+  if (!session || !session->connected || count < 0) return -1;
+
+  char *buf = malloc(FTP_PIPELINE_WINDOW * (FTP_RESPONSE_MAX + 2));
+  if (!buf) return -1;
+
+  /* Keep a window of commands in flight, sent together */
+  int sent = 0, done = 0;
+  int result = 0;
+  while (done < count) {
+    size_t len = 0;
+    while (sent < count && sent - done < FTP_PIPELINE_WINDOW) {
+      int n = snprintf(buf + len, FTP_RESPONSE_MAX + 2, "%.*s\r\n",
+                       FTP_RESPONSE_MAX - 1, cmds[sent]);
+      len += (size_t)n;
+      sent++;
+    }
+    if (len > 0 && write_control(session, buf, len) < 0) {
+      result = -1;
+      break;
+    }
+
+    int code = read_response(session);
+    if (code < 0) {
+      result = -1;
+      break;
+    }
+    if (on_reply) on_reply(done, code, session->last_response, ctx);
+    done++;
+  }
+
+  /* Commands without a reply failed */
+  if (result < 0 && on_reply) {
+    snprintf(session->last_response, sizeof(session->last_response),
+             "connection lost");
+    session->last_code = -1;
+    for (; done < count; done++) {
+      on_reply(done, -1, session->last_response, ctx);
+    }
+  }
+
+  free(buf);
+  return result;
+}
+
+
 const char *ftp_last_response(ftp_session_t *session) {
   if (!session) return "";
   return session->last_response;
@@ -4,6 +4,16 @@
  *
  * This module provides the core FTP client functionality including
  * connection management, authentication, and file transfer operations.
+ *
+ * After ftp_auth_tls() the control connection and every data connection
+ * are TLS connections (FTPS, RFC 4217). Data connections resume the
+ * control connection's session, so they skip the full handshake, and
+ * uploads are sent with sendfile() when the kernel does the encryption.
+ *
+ * After ftp_mode_z() transfers and listings travel as zlib streams
+ * (MODE Z): what arrives is inflated, and uploads are deflated, on
+ * several threads for large files and in stored blocks for files that
+ * are compressed already.
  */
 
 #ifndef FTP_CLIENT_H
@@ -12,6 +22,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <sys/types.h>
 
 /** Maximum length of an FTP response line. */
 #define FTP_RESPONSE_MAX 512
@@ -19,6 +30,27 @@
 /** Buffer size for file transfers. */
 #define FTP_BUFFER_SIZE 4096
 
+/** Buffer size for reading listings; longer lines are split. */
+#define FTP_LIST_BUFFER (64 * 1024)
+
+/** Size of the certificate authority file name of a session. */
+#define FTP_CA_MAX 1024
+
+/** Most pipelined commands awaiting a reply at once. */
+#define FTP_PIPELINE_WINDOW 64
+
+/** Local name for stdout in ftp_get() and stdin in ftp_put(). */
+#define FTP_STDIO "-"
+
+/** zlib level of MODE Z uploads. */
+#define FTP_ZLIB_LEVEL 6
+
+/** Smallest MODE Z upload deflated on several threads. */
+#define FTP_ZLIB_PARALLEL (4 * 1024 * 1024)
+
+/** Threads deflating a large MODE Z upload. */
+#define FTP_ZLIB_THREADS 4
+
 
 /**
  * @brief FTP client session state.
@@ -28,17 +60,76 @@
 typedef struct {
   int ctrl_fd;                        /**< Control connection socket. */
   int data_listen_fd;                 /**< Data port listening socket. */
+  int data_fd;                        /**< Passive data connection. */
   uint16_t data_port;                 /**< Data port number. */
+  bool passive;                       /**< Open data connections with EPSV
+                                           or PASV rather than PORT. */
+  char host[256];                     /**< Server given to ftp_connect(). */
+  uint16_t port;                      /**< Server control port. */
+  char user[64];                      /**< User given to ftp_login(). */
   char last_response[FTP_RESPONSE_MAX]; /**< Last response from server. */
   int last_code;                      /**< Last response code. */
   bool connected;                     /**< Whether connected to server. */
   bool logged_in;                     /**< Whether logged in. */
+  bool tls;                           /**< Whether ftp_auth_tls() secured
+                                           the session. */
+  bool mode_z;                        /**< Whether ftp_mode_z() turned on
+                                           MODE Z. */
+  bool tls_verify;                    /**< Check the server's certificate
+                                           and name; on by default. */
+  char tls_ca[FTP_CA_MAX];            /**< PEM file of trusted authorities,
+                                           or "" for the system's. */
+  struct ssl_ctx_st *tls_ctx;         /**< TLS context, or NULL. */
+  struct ssl_st *ctrl_tls;            /**< TLS of the control connection. */
+  struct ssl_st *data_tls;            /**< TLS of the data connection. */
+  struct ssl_session_st *tls_session; /**< Latest session, for data
+                                           connections to resume. */
+  char ctrl_buf[FTP_RESPONSE_MAX];    /**< Control input read ahead. */
+  size_t ctrl_len;                    /**< Bytes in ctrl_buf. */
+  size_t ctrl_pos;                    /**< Bytes of ctrl_buf consumed. */
 } ftp_session_t;
 
 
+/**
+ * @brief Facts of one entry of an MLSD listing.
+ */
+typedef struct {
+  const char *name;                   /**< Entry name. */
+  const char *type;                   /**< "file", "dir", etc., or "". */
+  long long size;                     /**< Size in bytes, or -1. */
+  const char *modify;                 /**< YYYYMMDDHHMMSS in UTC, or "". */
+} ftp_entry_t;
+
+
+/**
+ * @brief Called for each line of a listing as it arrives.
+ *
+ * @param line Line, without its CRLF; valid during the call only.
+ * @param ctx Caller's context.
+ * @return 0 to go on, anything else to stop the listing.
+ */
+typedef int (*ftp_line_fn)(const char *line, void *ctx);
+
+
+/**
+ * @brief Called for each entry of an MLSD listing as it arrives.
+ *
+ * @param entry Entry; valid during the call only.
+ * @param ctx Caller's context.
+ * @return 0 to go on, anything else to stop the listing.
+ */
+typedef int (*ftp_entry_fn)(const ftp_entry_t *entry, void *ctx);
+
+
 /**
  * @brief Initialize an FTP session structure.
  *
+ * Data connections are passive: the client connects to the port the
+ * server gives in reply to EPSV, or PASV if the server does not know
+ * EPSV, which works through NAT and firewalls and costs one round
+ * trip. A server knowing neither gets PORT. Clear session->passive
+ * to always use PORT.
+ *
  * @param session Pointer to session structure to initialize.
  */
 void ftp_session_init(ftp_session_t *session);
@@ -58,6 +149,49 @@ void ftp_session_init(ftp_session_t *session);
 int ftp_connect(ftp_session_t *session, const char *host, uint16_t port);
 
 
+/**
+ * @brief Secure the session with AUTH TLS, PBSZ 0 and PROT P.
+ *
+ * Call after ftp_connect() and before ftp_login(), so that the user
+ * name goes over TLS too. Set session->tls_verify and session->tls_ca
+ * first to change how the server's certificate is checked.
+ *
+ * @param session Pointer to connected session.
+ * @param resume Session of an earlier connection to the same server to
+ *        resume, from ftp_tls_ticket(), or NULL.
+ * @return 0 on success, -1 on error (the session cannot be used).
+ */
+int ftp_auth_tls(ftp_session_t *session, struct ssl_session_st *resume);
+
+
+/**
+ * @brief Take a reference to a secured session's latest TLS session,
+ *        so another connection can resume it.
+ *
+ * @param session Pointer to session.
+ * @return TLS session, or NULL if there is none; free it with
+ *         ftp_tls_ticket_free().
+ */
+struct ssl_session_st *ftp_tls_ticket(ftp_session_t *session);
+
+
+/**
+ * @brief Drop a reference from ftp_tls_ticket().
+ *
+ * @param ticket TLS session, or NULL.
+ */
+void ftp_tls_ticket_free(struct ssl_session_st *ticket);
+
+
+/**
+ * @brief Describe the TLS of a secured session.
+ *
+ * @param session Pointer to session.
+ * @return Protocol version, such as "TLSv1.3", or NULL without TLS.
+ */
+const char *ftp_tls_version(ftp_session_t *session);
+
+
 /**
  * @brief Log in to the FTP server.
  *
@@ -70,6 +204,20 @@ int ftp_connect(ftp_session_t *session, const char *host, uint16_t port);
 int ftp_login(ftp_session_t *session, const char *username);
 
 
+/**
+ * @brief Turn MODE Z, deflated data connections, on or off.
+ *
+ * Sends MODE Z or MODE S. A server without MODE Z refuses it with a
+ * 5xx reply, which ftp_last_code() then gives, and the session goes on
+ * uncompressed.
+ *
+ * @param session Pointer to logged-in session.
+ * @param on true for MODE Z, false for MODE S.
+ * @return 0 on success, -1 if the server refused or on error.
+ */
+int ftp_mode_z(ftp_session_t *session, bool on);
+
+
 /**
  * @brief Disconnect from the FTP server.
  *
@@ -94,40 +242,101 @@ void ftp_close(ftp_session_t *session);
 /**
  * @brief Get directory listing from server.
  *
- * Retrieves an ls -l style directory listing from the server.
+ * Retrieves an ls -l style directory listing from the server and hands
+ * it to fn a line at a time as it arrives, so that memory use does not
+ * grow with the directory.
  *
  * @param session Pointer to logged-in session.
  * @param path Optional path to list (NULL for current directory).
- * @param output Pointer to store allocated listing string. Caller must free.
- * @return 0 on success, -1 on error.
+ * @param fn Called for each line.
+ * @param ctx Passed to fn.
+ * @return 0 on success (including fn stopping the listing), -1 on error.
  */
-int ftp_list(ftp_session_t *session, const char *path, char **output);
+int ftp_list(ftp_session_t *session, const char *path, ftp_line_fn fn,
+             void *ctx);
+
+
+/**
+ * @brief Get a machine-readable directory listing from server.
+ *
+ * Like ftp_list(), but with MLSD, whose lines are parsed into facts.
+ *
+ * @param session Pointer to logged-in session.
+ * @param path Optional path to list (NULL for current directory).
+ * @param fn Called for each entry.
+ * @param ctx Passed to fn.
+ * @return 0 on success (including fn stopping the listing), -1 on error.
+ */
+int ftp_mlsd(ftp_session_t *session, const char *path, ftp_entry_fn fn,
+             void *ctx);
 
 
 /**
  * @brief Download a file from the server.
  *
- * Retrieves a file from the server and saves it locally.
+ * Retrieves a file from the server and saves it locally. With
+ * FTP_STDIO as the local name the file is written to stdout as it
+ * arrives, spliced from the data connection when stdout is a pipe.
  *
  * @param session Pointer to logged-in session.
  * @param remote Remote filename to download.
  * @param local Local filename to save to (NULL to use remote name).
+ * @param resume If true and the local file exists, fetch only the bytes
+ *        after its end, with REST, and append them. Ignored for stdout.
  * @return 0 on success, -1 on error.
  */
-int ftp_get(ftp_session_t *session, const char *remote, const char *local);
+int ftp_get(ftp_session_t *session, const char *remote, const char *local,
+            bool resume);
 
 
 /**
  * @brief Upload a file to the server.
  *
- * Sends a local file to the server.
+ * Sends a local file to the server. With FTP_STDIO as the local name
+ * stdin is sent until its end, spliced to the data connection when it
+ * is a pipe; remote must then be given, and append cannot be used.
  *
  * @param session Pointer to logged-in session.
  * @param local Local filename to upload.
  * @param remote Remote filename to save as (NULL to use local name).
+ * @param append If true and the remote file exists, send only the
+ *        bytes of the local file after the remote file's size, with
+ *        APPE, to finish an interrupted upload.
+ * @return 0 on success, -1 on error.
+ */
+int ftp_put(ftp_session_t *session, const char *local, const char *remote,
+            bool append);
+
+
+/**
+ * @brief Download part of a file from the server into an open file.
+ *
+ * Fetches length bytes of the remote file from offset, with REST, and
+ * writes them with pwrite() at the same offset of fd, so that several
+ * sessions can fill different parts of one file at once. The data
+ * connection is closed once the range has arrived, so the server may
+ * end the transfer with 426 rather than 226.
+ *
+ * @param session Pointer to logged-in session.
+ * @param remote Remote filename.
+ * @param fd Local file open for writing.
+ * @param offset First byte to fetch.
+ * @param length Number of bytes to fetch.
  * @return 0 on success, -1 on error.
  */
-int ftp_put(ftp_session_t *session, const char *local, const char *remote);
+int ftp_get_range(ftp_session_t *session, const char *remote, int fd,
+                  off_t offset, off_t length);
+
+
+/**
+ * @brief Get the size of a remote file.
+ *
+ * @param session Pointer to logged-in session.
+ * @param remote Remote filename.
+ * @param size Set to the size in bytes.
+ * @return 0 on success, -1 on error (including no such file).
+ */
+int ftp_size(ftp_session_t *session, const char *remote, off_t *size);
 
 
 /**
@@ -140,6 +349,43 @@ int ftp_put(ftp_session_t *session, const char *local, const char *remote);
 int ftp_mkdir(ftp_session_t *session, const char *dirname);
 
 
+/**
+ * @brief Remove a file on the server (DELE).
+ *
+ * @param session Pointer to logged-in session.
+ * @param remote Remote filename.
+ * @return 0 on success, -1 on error.
+ */
+int ftp_delete(ftp_session_t *session, const char *remote);
+
+
+/**
+ * @brief Remove an empty directory on the server (RMD).
+ *
+ * @param session Pointer to logged-in session.
+ * @param dirname Directory to remove.
+ * @return 0 on success, -1 on error.
+ */
+int ftp_rmdir(ftp_session_t *session, const char *dirname);
+
+
+/**
+ * @brief Get the SHA-256 digest of a remote file (HASH).
+ *
+ * The server reads the file, so its contents can be compared without
+ * fetching it. Servers without HASH reply 500 or 502, which
+ * ftp_last_code() then gives.
+ *
+ * @param session Pointer to logged-in session.
+ * @param remote Remote filename.
+ * @param hex Set to the digest in lower-case hex.
+ * @param hexsize Size of hex; at least 65.
+ * @return 0 on success, -1 on error.
+ */
+int ftp_hash(ftp_session_t *session, const char *remote, char *hex,
+             size_t hexsize);
+
+
 /**
  * @brief Get current working directory.
  *
@@ -173,6 +419,38 @@ int ftp_cd(ftp_session_t *session, const char *path);
 int ftp_command(ftp_session_t *session, const char *cmd);
 
 
+/**
+ * @brief Called with the reply to each command of ftp_pipeline().
+ *
+ * @param index Index of the command.
+ * @param code Reply code, or -1 if the connection failed first.
+ * @param response Reply line.
+ * @param ctx Context given to ftp_pipeline().
+ */
+typedef void (*ftp_reply_fn)(int index, int code, const char *response,
+                             void *ctx);
+
+
+/**
+ * @brief Send commands without waiting for each reply.
+ *
+ * Up to FTP_PIPELINE_WINDOW commands are in flight at once, so a batch
+ * costs about one round trip per window rather than one per command.
+ * Replies come back in order. Only commands that need no data
+ * connection may be pipelined, and each must be independent of the
+ * replies to those before it.
+ *
+ * @param session Pointer to connected session.
+ * @param cmds Commands (without CRLF).
+ * @param count Number of commands.
+ * @param on_reply Called with each reply in order, or NULL.
+ * @param ctx Passed to on_reply.
+ * @return 0 if every command got a reply, -1 if the connection failed.
+ */
+int ftp_pipeline(ftp_session_t *session, const char *const *cmds, int count,
+                 ftp_reply_fn on_reply, void *ctx);
+
+
 /**
  * @brief Get the last response message.
  *
@@ -3,6 +3,10 @@
  * @brief FTP client interactive mode implementation.
  *
  * Provides a command-line interface for interacting with the FTP server.
+ *
+ * In batch mode, runs of mkdir and cd, which need only the control
+ * connection, are pipelined: they are sent without waiting for each
+ * reply, and the replies are reported in order once they arrive.
  */
 
 #include <stdio.h>
@@ -11,13 +15,30 @@
 #include <ctype.h>
 
 #include "ftp_interactive.h"
+#include "ftp_mirror.h"
+#include "ftp_parallel.h"
 
 
 /** Maximum length of an interactive command line. */
-#define MAX_CMD_LINE 1024
+#define MAX_CMD_LINE 4096
 
 /** Maximum number of arguments in a command. */
-#define MAX_ARGS 8
+#define MAX_ARGS 128
+
+/** Most commands of a batch pipelined together. */
+#define MAX_PIPELINED 1024
+
+
+/**
+ * @brief Commands of a batch waiting to be pipelined.
+ */
+typedef struct {
+  char *cmds[MAX_PIPELINED];  /**< FTP commands. */
+  char *args[MAX_PIPELINED];  /**< Their arguments, for reporting. */
+  bool cd[MAX_PIPELINED];     /**< Whether a command is cd, not mkdir. */
+  int count;                  /**< Commands waiting. */
+  bool json_output;           /**< JSON output mode. */
+} pipeline_t;
 
 
 /**
@@ -29,10 +50,14 @@ static void print_help(bool json_output) {
   if (json_output) {
     printf("{\"commands\":[");
     printf("{\"name\":\"ls\",\"usage\":\"ls [path]\",\"desc\":\"List directory\"},");
+    printf("{\"name\":\"mls\",\"usage\":\"mls [path]\",\"desc\":\"List directory with facts\"},");
     printf("{\"name\":\"cd\",\"usage\":\"cd <path>\",\"desc\":\"Change directory\"},");
     printf("{\"name\":\"pwd\",\"usage\":\"pwd\",\"desc\":\"Print working directory\"},");
-    printf("{\"name\":\"get\",\"usage\":\"get <remote> [local]\",\"desc\":\"Download file\"},");
-    printf("{\"name\":\"put\",\"usage\":\"put <local> [remote]\",\"desc\":\"Upload file\"},");
+    printf("{\"name\":\"get\",\"usage\":\"get [--resume] <remote> [local]\",\"desc\":\"Download file\"},");
+    printf("{\"name\":\"put\",\"usage\":\"put [--append] <local> [remote]\",\"desc\":\"Upload file\"},");
+    printf("{\"name\":\"mget\",\"usage\":\"mget [-n sessions] <remote>...\",\"desc\":\"Download files in parallel\"},");
+    printf("{\"name\":\"mput\",\"usage\":\"mput [-n sessions] <local>...\",\"desc\":\"Upload files in parallel\"},");
+    printf("{\"name\":\"mirror\",\"usage\":\"mirror [-R] [--delete] [--checksum] [-n sessions] <remote> <local>\",\"desc\":\"Transfer only what differs between two trees\"},");
     printf("{\"name\":\"mkdir\",\"usage\":\"mkdir <dir>\",\"desc\":\"Create directory\"},");
     printf("{\"name\":\"help\",\"usage\":\"help\",\"desc\":\"Show commands\"},");
     printf("{\"name\":\"quit\",\"usage\":\"quit\",\"desc\":\"Disconnect and exit\"}");
@@ -40,10 +65,22 @@ static void print_help(bool json_output) {
   } else {
     printf("Available commands:\n");
     printf("  ls [path]            List directory contents\n");
+    printf("  mls [path]           List type, size and time of entries\n");
     printf("  cd <path>            Change directory\n");
     printf("  pwd                  Print working directory\n");
     printf("  get <remote> [local] Download file\n");
+    printf("      --resume         Fetch only what the local file lacks\n");
     printf("  put <local> [remote] Upload file\n");
+    printf("      --append         Send only what the remote file lacks\n");
+    printf("  mget <remote>...     Download files over parallel sessions\n");
+    printf("  mput <local>...      Upload files over parallel sessions\n");
+    printf("      -n <sessions>    Number of sessions (default %d)\n",
+           FTP_PARALLEL_DEFAULT);
+    printf("  mirror <remote> <local>\n");
+    printf("                       Download only what differs from local\n");
+    printf("      -R               Upload local to remote instead\n");
+    printf("      --delete         Remove what the source lacks\n");
+    printf("      --checksum       Compare files by SHA-256 (HASH)\n");
     printf("  mkdir <dir>          Create directory\n");
     printf("  help                 Show this help\n");
     printf("  quit                 Disconnect and exit\n");
@@ -89,58 +126,217 @@ static int parse_args(char *line, char **argv, int max_args) {
 
 
 /**
- * @brief Handle the ls command.
+ * @brief Remove an option from the front of a command's arguments.
+ *
+ * @param argc Argument count, decremented if the option is found.
+ * @param argv Arguments; the option, if argv[1], is removed.
+ * @param name Long option name.
+ * @param short_name Short option name.
+ * @return true if the option was found.
+ */
+static bool take_option(int *argc, char **argv, const char *name,
+                        const char *short_name) {
+  if (*argc < 2 ||
+      (strcmp(argv[1], name) != 0 && strcmp(argv[1], short_name) != 0)) {
+    return false;
+  }
+  memmove(&argv[1], &argv[2], (size_t)(*argc - 2) * sizeof(argv[0]));
+  (*argc)--;
+  return true;
+}
+
+
+/**
+ * @brief Remove a -n <sessions> option from the front of a command's
+ *        arguments.
+ *
+ * @param argc Argument count, reduced if the option is found.
+ * @param argv Arguments; the option, if argv[1], is removed.
+ * @param sessions Set to the number given, or FTP_PARALLEL_DEFAULT.
+ * @return 0 on success, -1 if the number is missing or out of range.
+ */
+static int take_sessions(int *argc, char **argv, int *sessions) {
+  *sessions = FTP_PARALLEL_DEFAULT;
+  if (*argc < 2 || strcmp(argv[1], "-n") != 0) return 0;
+  if (*argc < 3) return -1;
+
+  char *end;
+  long value = strtol(argv[2], &end, 10);
+  if (*end || value < 1 || value > FTP_PARALLEL_MAX) return -1;
+
+  *sessions = (int)value;
+  memmove(&argv[1], &argv[3], (size_t)(*argc - 3) * sizeof(argv[0]));
+  *argc -= 2;
+  return 0;
+}
+
+
+/**
+ * @brief Print a string for use inside a JSON string.
+ *
+ * @param s String to print.
+ */
+static void print_json_escaped(const char *s) {
+  for (const char *p = s; *p; p++) {
+    switch (*p) {
+      case '"':  printf("\\\""); break;
+      case '\\': printf("\\\\"); break;
+      case '\n': printf("\\n"); break;
+      case '\r': break;
+      case '\t': printf("\\t"); break;
+      default:
+        if ((unsigned char)*p >= 32) {
+          putchar(*p);
+        }
+        break;
+    }
+  }
+}
+
+
+/** State of a listing being printed as it arrives. */
+typedef struct {
+  bool json_output;
+  bool started;             /**< Whether the JSON head has been printed. */
+} listing_print_t;
+
+
+/**
+ * @brief Print a line of an ls listing.
+ *
+ * In JSON mode the lines form the "listing" string, which is opened
+ * before the first.
+ *
+ * @param line Line of the listing.
+ * @param ctx The listing_print_t of the listing.
+ * @return 0 to go on.
+ */
+static int print_list_line(const char *line, void *ctx) {
+  listing_print_t *out = ctx;
+
+  if (!out->json_output) {
+    printf("%s\n", line);
+    return 0;
+  }
+
+  if (!out->started) {
+    printf("{\"action\":\"ls\",\"listing\":\"");
+    out->started = true;
+  }
+  print_json_escaped(line);
+  printf("\\n");
+  return 0;
+}
+
+
+/**
+ * @brief Print an entry of an mls listing.
+ *
+ * In JSON mode the entries form the "entries" array, which is opened
+ * before the first.
+ *
+ * @param entry Entry of the listing.
+ * @param ctx The listing_print_t of the listing.
+ * @return 0 to go on.
+ */
+static int print_mlsd_entry(const ftp_entry_t *entry, void *ctx) {
+  listing_print_t *out = ctx;
+
+  if (!out->json_output) {
+    const char *m = entry->modify;
+    if (strlen(m) >= 12) {
+      printf("%-4s %12lld %.4s-%.2s-%.2s %.2s:%.2s %s\n", entry->type,
+             entry->size, m, m + 4, m + 6, m + 8, m + 10, entry->name);
+    } else {
+      printf("%-4s %12lld %16s %s\n", entry->type, entry->size, m,
+             entry->name);
+    }
+    return 0;
+  }
+
+  printf(out->started ? "," : "{\"action\":\"mls\",\"entries\":[");
+  out->started = true;
+  printf("{\"name\":\"");
+  print_json_escaped(entry->name);
+  printf("\",\"type\":\"");
+  print_json_escaped(entry->type);
+  printf("\",\"size\":%lld,\"modify\":\"", entry->size);
+  print_json_escaped(entry->modify);
+  printf("\"}");
+  return 0;
+}
+
+
+/**
+ * @brief Handle the ls and mls commands.
+ *
+ * The listing is printed as it arrives. In JSON mode the status comes
+ * last, since an error may follow part of the listing.
  *
  * @param session FTP session.
  * @param path Optional path to list.
+ * @param facts true for mls (MLSD), false for ls (LIST).
  * @param json_output JSON output mode.
  */
-static void handle_ls(ftp_session_t *session, const char *path,
+static void handle_ls(ftp_session_t *session, const char *path, bool facts,
                       bool json_output) {
-  char *listing = NULL;
+  const char *action = facts ? "mls" : "ls";
+  listing_print_t out = { .json_output = json_output };
 
-  if (ftp_list(session, path, &listing) < 0) {
-    if (json_output) {
-      printf("{\"action\":\"ls\",\"status\":\"error\","
-             "\"message\":\"%s\"}\n", ftp_last_response(session));
-    } else {
+  int rc = facts ? ftp_mlsd(session, path, print_mlsd_entry, &out)
+                 : ftp_list(session, path, print_list_line, &out);
+
+  if (!json_output) {
+    if (rc < 0) {
       fprintf(stderr, "ftp: list failed: %s\n", ftp_last_response(session));
     }
     return;
   }
 
-  if (json_output) {
-    /* Output listing as JSON - escape special characters */
-    printf("{\"action\":\"ls\",\"status\":\"ok\",\"listing\":\"");
-    if (listing) {
-      for (const char *p = listing; *p; p++) {
-        switch (*p) {
-          case '"':  printf("\\\""); break;
-          case '\\': printf("\\\\"); break;
-          case '\n': printf("\\n"); break;
-          case '\r': break;
-          case '\t': printf("\\t"); break;
-          default:
-            if ((unsigned char)*p >= 32) {
-              putchar(*p);
-            }
-            break;
-        }
-      }
+  if (!out.started) {
+    if (rc < 0) {
+      printf("{\"action\":\"%s\",\"status\":\"error\","
+             "\"message\":\"%s\"}\n", action, ftp_last_response(session));
+      return;
     }
-    printf("\"}\n");
+    printf(facts ? "{\"action\":\"mls\",\"entries\":["
+                 : "{\"action\":\"ls\",\"listing\":\"");
+  }
+  printf(facts ? "]" : "\"");
+  if (rc < 0) {
+    printf(",\"status\":\"error\",\"message\":\"%s\"}\n",
+           ftp_last_response(session));
   } else {
-    if (listing && *listing) {
-      printf("%s", listing);
-      /* Ensure trailing newline */
-      size_t len = strlen(listing);
-      if (len > 0 && listing[len - 1] != '\n') {
-        putchar('\n');
-      }
+    printf(",\"status\":\"ok\"}\n");
+  }
+}
+
+
+/**
+ * @brief Report the outcome of a cd command.
+ *
+ * @param path Directory changed to.
+ * @param ok Whether the server accepted it.
+ * @param response The server's reply.
+ * @param json_output JSON output mode.
+ */
+static void report_cd(const char *path, bool ok, const char *response,
+                      bool json_output) {
+  if (!ok) {
+    if (json_output) {
+      printf("{\"action\":\"cd\",\"status\":\"error\","
+             "\"message\":\"%s\"}\n", response);
+    } else {
+      fprintf(stderr, "ftp: cd failed: %s\n", response);
     }
+    return;
   }
 
-  free(listing);
+  if (json_output) {
+    printf("{\"action\":\"cd\",\"status\":\"ok\",\"path\":\"%s\"}\n", path);
+  } else {
+    printf("Changed to %s\n", path);
+  }
 }
 
 
@@ -163,21 +359,8 @@ static void handle_cd(ftp_session_t *session, const char *path,
     return;
   }
 
-  if (ftp_cd(session, path) < 0) {
-    if (json_output) {
-      printf("{\"action\":\"cd\",\"status\":\"error\","
-             "\"message\":\"%s\"}\n", ftp_last_response(session));
-    } else {
-      fprintf(stderr, "ftp: cd failed: %s\n", ftp_last_response(session));
-    }
-    return;
-  }
-
-  if (json_output) {
-    printf("{\"action\":\"cd\",\"status\":\"ok\",\"path\":\"%s\"}\n", path);
-  } else {
-    printf("Changed to %s\n", path);
-  }
+  report_cd(path, ftp_cd(session, path) == 0, ftp_last_response(session),
+            json_output);
 }
 
 
@@ -211,13 +394,18 @@ static void handle_pwd(ftp_session_t *session, bool json_output) {
 /**
  * @brief Handle the get command.
  *
+ * With "-" as the local name the file goes to stdout, so the report
+ * goes to stderr instead.
+ *
  * @param session FTP session.
  * @param remote Remote filename.
  * @param local Local filename (NULL to use remote name).
+ * @param resume Whether to resume a partial download.
  * @param json_output JSON output mode.
+ * @return 0 on success, -1 on failure.
  */
-static void handle_get(ftp_session_t *session, const char *remote,
-                       const char *local, bool json_output) {
+static int handle_get(ftp_session_t *session, const char *remote,
+                      const char *local, bool resume, bool json_output) {
   if (!remote || !*remote) {
     if (json_output) {
       printf("{\"action\":\"get\",\"status\":\"error\","
@@ -225,28 +413,33 @@ static void handle_get(ftp_session_t *session, const char *remote,
     } else {
       fprintf(stderr, "ftp: get: missing remote filename\n");
     }
-    return;
+    return -1;
   }
 
   const char *local_name = local && *local ? local : remote;
+  bool to_stdout = strcmp(local_name, FTP_STDIO) == 0;
+  FILE *report = to_stdout ? stderr : stdout;
 
-  if (ftp_get(session, remote, local_name) < 0) {
+  /* What was printed goes out before the file does */
+  fflush(stdout);
+  if (ftp_get(session, remote, local_name, resume) < 0) {
     if (json_output) {
-      printf("{\"action\":\"get\",\"status\":\"error\","
-             "\"remote\":\"%s\",\"message\":\"%s\"}\n",
-             remote, ftp_last_response(session));
+      fprintf(report, "{\"action\":\"get\",\"status\":\"error\","
+              "\"remote\":\"%s\",\"message\":\"%s\"}\n",
+              remote, ftp_last_response(session));
     } else {
       fprintf(stderr, "ftp: get failed: %s\n", ftp_last_response(session));
     }
-    return;
+    return -1;
   }
 
   if (json_output) {
-    printf("{\"action\":\"get\",\"status\":\"ok\","
-           "\"remote\":\"%s\",\"local\":\"%s\"}\n", remote, local_name);
-  } else {
+    fprintf(report, "{\"action\":\"get\",\"status\":\"ok\","
+            "\"remote\":\"%s\",\"local\":\"%s\"}\n", remote, local_name);
+  } else if (!to_stdout) {
     printf("Downloaded %s -> %s\n", remote, local_name);
   }
+  return 0;
 }
 
 
@@ -254,12 +447,17 @@ static void handle_get(ftp_session_t *session, const char *remote,
  * @brief Handle the put command.
  *
  * @param session FTP session.
- * @param local Local filename.
+ * @param local Local filename, or "-" for stdin.
  * @param remote Remote filename (NULL to use local name).
+ * @param append Whether to finish a partial upload.
+ * @param stdin_busy Whether stdin carries the commands, so cannot be
+ *        uploaded.
  * @param json_output JSON output mode.
+ * @return 0 on success, -1 on failure.
  */
-static void handle_put(ftp_session_t *session, const char *local,
-                       const char *remote, bool json_output) {
+static int handle_put(ftp_session_t *session, const char *local,
+                      const char *remote, bool append, bool stdin_busy,
+                      bool json_output) {
   if (!local || !*local) {
     if (json_output) {
       printf("{\"action\":\"put\",\"status\":\"error\","
@@ -267,7 +465,17 @@ static void handle_put(ftp_session_t *session, const char *local,
     } else {
       fprintf(stderr, "ftp: put: missing local filename\n");
     }
-    return;
+    return -1;
+  }
+  if (stdin_busy && strcmp(local, FTP_STDIO) == 0) {
+    if (json_output) {
+      printf("{\"action\":\"put\",\"status\":\"error\","
+             "\"message\":\"stdin holds the commands\"}\n");
+    } else {
+      fprintf(stderr, "ftp: put: stdin holds the commands; use -b FILE "
+                      "or run put as a single command\n");
+    }
+    return -1;
   }
 
   /* Extract basename for default remote name */
@@ -275,7 +483,8 @@ static void handle_put(ftp_session_t *session, const char *local,
   base = base ? base + 1 : local;
   const char *remote_name = remote && *remote ? remote : base;
 
-  if (ftp_put(session, local, remote_name) < 0) {
+  if (ftp_put(session, local, remote && *remote ? remote_name : NULL,
+              append) < 0) {
     if (json_output) {
       printf("{\"action\":\"put\",\"status\":\"error\","
              "\"local\":\"%s\",\"message\":\"%s\"}\n",
@@ -283,7 +492,7 @@ static void handle_put(ftp_session_t *session, const char *local,
     } else {
       fprintf(stderr, "ftp: put failed: %s\n", ftp_last_response(session));
     }
-    return;
+    return -1;
   }
 
   if (json_output) {
@@ -292,35 +501,204 @@ static void handle_put(ftp_session_t *session, const char *local,
   } else {
     printf("Uploaded %s -> %s\n", local, remote_name);
   }
+  return 0;
 }
 
 
 /**
- * @brief Handle the mkdir command.
+ * @brief Handle the mget and mput commands.
+ *
+ * Each file keeps its base name on the other side.
  *
  * @param session FTP session.
- * @param dirname Directory name to create.
+ * @param upload true for mput, false for mget.
+ * @param argc Argument count, including the command.
+ * @param argv Arguments.
  * @param json_output JSON output mode.
  */
-static void handle_mkdir(ftp_session_t *session, const char *dirname,
-                         bool json_output) {
-  if (!dirname || !*dirname) {
+static void handle_transfer_many(ftp_session_t *session, bool upload,
+                                 int argc, char **argv, bool json_output) {
+  const char *action = upload ? "mput" : "mget";
+  int sessions;
+
+  if (take_sessions(&argc, argv, &sessions) < 0 || argc < 2) {
+    const char *message = argc < 2 ? "missing filename"
+                                    : "invalid number of sessions";
     if (json_output) {
-      printf("{\"action\":\"mkdir\",\"status\":\"error\","
-             "\"message\":\"missing directory name\"}\n");
+      printf("{\"action\":\"%s\",\"status\":\"error\","
+             "\"message\":\"%s\"}\n", action, message);
     } else {
-      fprintf(stderr, "ftp: mkdir: missing directory name\n");
+      fprintf(stderr, "ftp: %s: %s\n", action, message);
     }
     return;
   }
 
-  if (ftp_mkdir(session, dirname) < 0) {
+  size_t count = (size_t)argc - 1;
+  ftp_transfer_t *files = calloc(count, sizeof(*files));
+  if (!files) {
+    fprintf(stderr, "ftp: %s: out of memory\n", action);
+    return;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    const char *name = argv[i + 1];
+    const char *base = strrchr(name, '/');
+    base = base ? base + 1 : name;
+    files[i].remote = upload ? base : name;
+    files[i].local = upload ? name : base;
+  }
+
+  if (upload) {
+    ftp_mput(session, files, count, sessions);
+  } else {
+    ftp_mget(session, files, count, sessions);
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    ftp_transfer_t *file = &files[i];
+    const char *from = upload ? file->local : file->remote;
+    const char *to = upload ? file->remote : file->local;
+
+    if (file->status < 0) {
+      if (json_output) {
+        printf("{\"action\":\"%s\",\"status\":\"error\","
+               "\"remote\":\"%s\",\"local\":\"%s\",\"message\":\"%s\"}\n",
+               action, file->remote, file->local, file->message);
+      } else {
+        fprintf(stderr, "ftp: %s %s failed: %s\n", action, from,
+                file->message);
+      }
+    } else if (json_output) {
+      printf("{\"action\":\"%s\",\"status\":\"ok\","
+             "\"remote\":\"%s\",\"local\":\"%s\"}\n",
+             action, file->remote, file->local);
+    } else {
+      printf("%s %s -> %s\n", upload ? "Uploaded" : "Downloaded", from, to);
+    }
+  }
+
+  free(files);
+}
+
+
+/** State of a mirror being reported. */
+typedef struct {
+  bool json_output;
+} mirror_print_t;
+
+
+/**
+ * @brief Print a change made by mirror.
+ *
+ * @param op Change: get, put, mkdir, delete or list.
+ * @param path Path below the mirrored directories.
+ * @param message NULL on success, the reason otherwise.
+ * @param ctx The mirror_print_t of the mirror.
+ */
+static void print_mirror_change(const char *op, const char *path,
+                                const char *message, void *ctx) {
+  mirror_print_t *out = ctx;
+
+  if (out->json_output) {
+    printf("{\"action\":\"mirror\",\"op\":\"%s\",\"path\":\"", op);
+    print_json_escaped(path);
+    if (message) {
+      printf("\",\"status\":\"error\",\"message\":\"");
+      print_json_escaped(message);
+      printf("\"}\n");
+    } else {
+      printf("\",\"status\":\"ok\"}\n");
+    }
+  } else if (message) {
+    fprintf(stderr, "ftp: mirror: %s %s failed: %s\n", op,
+            *path ? path : ".", message);
+  } else {
+    printf("%-6s %s\n", op, path);
+  }
+}
+
+
+/**
+ * @brief Handle the mirror command.
+ *
+ * @param session FTP session.
+ * @param argc Argument count, including the command.
+ * @param argv Arguments; options are removed.
+ * @param json_output JSON output mode.
+ * @return 0 if every change was made, -1 otherwise.
+ */
+static int handle_mirror(ftp_session_t *session, int argc, char **argv,
+                         bool json_output) {
+  ftp_mirror_opts_t opts = { .connections = FTP_PARALLEL_DEFAULT };
+  const char *message = NULL;
+
+  while (argc > 1 && argv[1][0] == '-' && !message) {
+    if (strcmp(argv[1], "-n") == 0) {
+      if (take_sessions(&argc, argv, &opts.connections) < 0) {
+        message = "invalid number of sessions";
+      }
+    } else if (take_option(&argc, argv, "--reverse", "-R")) {
+      opts.push = true;
+    } else if (take_option(&argc, argv, "--delete", "-d")) {
+      opts.delete_extra = true;
+    } else if (take_option(&argc, argv, "--checksum", "-C")) {
+      opts.checksum = true;
+    } else {
+      message = "unknown option";
+    }
+  }
+  if (!message && argc != 3) {
+    message = "usage: mirror [-R] [--delete] [--checksum] [-n N] "
+              "<remote> <local>";
+  }
+  if (message) {
+    if (json_output) {
+      printf("{\"action\":\"mirror\",\"status\":\"error\","
+             "\"message\":\"%s\"}\n", message);
+    } else {
+      fprintf(stderr, "ftp: mirror: %s\n", message);
+    }
+    return -1;
+  }
+
+  mirror_print_t out = { .json_output = json_output };
+  ftp_mirror_stats_t stats;
+  int rc = ftp_mirror(session, argv[1], argv[2], &opts, print_mirror_change,
+                      &out, &stats);
+
+  if (json_output) {
+    printf("{\"action\":\"mirror\",\"status\":\"%s\","
+           "\"transferred\":%zu,\"deleted\":%zu,\"unchanged\":%zu,"
+           "\"failed\":%zu,\"bytes\":%lld}\n",
+           rc < 0 ? "error" : "ok", stats.transferred, stats.deleted,
+           stats.unchanged, stats.failed, stats.bytes);
+  } else {
+    printf("Mirrored %s %s %s: %zu transferred (%lld bytes), %zu deleted, "
+           "%zu unchanged%s\n", argv[1], opts.push ? "<-" : "->", argv[2],
+           stats.transferred, stats.bytes, stats.deleted, stats.unchanged,
+           stats.failed ? ", some changes failed" : "");
+  }
+  return rc;
+}
+
+
+/**
+ * @brief Report the outcome of a mkdir command.
+ *
+ * @param dirname Directory created.
+ * @param ok Whether the server created it.
+ * @param response The server's reply.
+ * @param json_output JSON output mode.
+ */
+static void report_mkdir(const char *dirname, bool ok, const char *response,
+                         bool json_output) {
+  if (!ok) {
     if (json_output) {
       printf("{\"action\":\"mkdir\",\"status\":\"error\","
              "\"dir\":\"%s\",\"message\":\"%s\"}\n",
-             dirname, ftp_last_response(session));
+             dirname, response);
     } else {
-      fprintf(stderr, "ftp: mkdir failed: %s\n", ftp_last_response(session));
+      fprintf(stderr, "ftp: mkdir failed: %s\n", response);
     }
     return;
   }
@@ -334,26 +712,196 @@ static void handle_mkdir(ftp_session_t *session, const char *dirname,
 }
 
 
-int ftp_interactive(ftp_session_t *session, bool json_output) {
+/**
+ * @brief Handle the mkdir command.
+ *
+ * @param session FTP session.
+ * @param dirname Directory name to create.
+ * @param json_output JSON output mode.
+ */
+static void handle_mkdir(ftp_session_t *session, const char *dirname,
+                         bool json_output) {
+  if (!dirname || !*dirname) {
+    if (json_output) {
+      printf("{\"action\":\"mkdir\",\"status\":\"error\","
+             "\"message\":\"missing directory name\"}\n");
+    } else {
+      fprintf(stderr, "ftp: mkdir: missing directory name\n");
+    }
+    return;
+  }
+
+  report_mkdir(dirname, ftp_mkdir(session, dirname) == 0,
+               ftp_last_response(session), json_output);
+}
+
+
+/**
+ * @brief Report the reply to a pipelined command.
+ *
+ * @param index Index of the command.
+ * @param code Reply code, or -1.
+ * @param response Reply line.
+ * @param ctx The pipeline.
+ */
+static void report_pipelined(int index, int code, const char *response,
+                             void *ctx) {
+  pipeline_t *pipe = ctx;
+  if (pipe->cd[index]) {
+    report_cd(pipe->args[index], code == 250, response, pipe->json_output);
+  } else {
+    report_mkdir(pipe->args[index], code == 257, response,
+                 pipe->json_output);
+  }
+}
+
+
+/**
+ * @brief Send the commands waiting in a pipeline and report them.
+ *
+ * @param session FTP session.
+ * @param pipe Pipeline; emptied.
+ */
+static void flush_pipeline(ftp_session_t *session, pipeline_t *pipe) {
+  if (pipe->count == 0) return;
+
+  ftp_pipeline(session, (const char *const *)pipe->cmds, pipe->count,
+               report_pipelined, pipe);
+  fflush(stdout);
+
+  for (int i = 0; i < pipe->count; i++) {
+    free(pipe->cmds[i]);
+    free(pipe->args[i]);
+  }
+  pipe->count = 0;
+}
+
+
+/**
+ * @brief Queue a mkdir or cd for pipelining.
+ *
+ * @param session FTP session, for flushing a full pipeline.
+ * @param pipe Pipeline.
+ * @param cd Whether the command is cd rather than mkdir.
+ * @param arg Its argument.
+ * @return true if queued, false if out of memory.
+ */
+static bool queue_pipelined(ftp_session_t *session, pipeline_t *pipe,
+                            bool cd, const char *arg) {
+  if (pipe->count == MAX_PIPELINED) {
+    flush_pipeline(session, pipe);
+  }
+
+  size_t len = strlen(arg) + 5;
+  char *cmd = malloc(len);
+  char *copy = strdup(arg);
+  if (!cmd || !copy) {
+    free(cmd);
+    free(copy);
+    return false;
+  }
+  snprintf(cmd, len, "%s %s", cd ? "CWD" : "MKD", arg);
+
+  pipe->cmds[pipe->count] = cmd;
+  pipe->args[pipe->count] = copy;
+  pipe->cd[pipe->count] = cd;
+  pipe->count++;
+  return true;
+}
+
+
+/**
+ * @brief Run one parsed command.
+ *
+ * @param session FTP session.
+ * @param argc Argument count; at least 1.
+ * @param argv Command and its arguments (options may be removed).
+ * @param stdin_busy Whether stdin carries the commands.
+ * @param json_output JSON output mode.
+ * @return 1 for quit, 0 when the command ran, -1 when get, put or mirror
+ *         failed.
+ */
+static int run_command(ftp_session_t *session, int argc, char **argv,
+                       bool stdin_busy, bool json_output) {
+  const char *cmd = argv[0];
+
+  if (strcmp(cmd, "quit") == 0 || strcmp(cmd, "exit") == 0) {
+    if (json_output) {
+      printf("{\"action\":\"quit\",\"status\":\"ok\"}\n");
+    } else {
+      printf("Goodbye.\n");
+    }
+    return 1;
+  } else if (strcmp(cmd, "help") == 0 || strcmp(cmd, "?") == 0) {
+    print_help(json_output);
+  } else if (strcmp(cmd, "ls") == 0 || strcmp(cmd, "dir") == 0) {
+    handle_ls(session, argc > 1 ? argv[1] : NULL, false, json_output);
+  } else if (strcmp(cmd, "mls") == 0) {
+    handle_ls(session, argc > 1 ? argv[1] : NULL, true, json_output);
+  } else if (strcmp(cmd, "cd") == 0) {
+    handle_cd(session, argc > 1 ? argv[1] : NULL, json_output);
+  } else if (strcmp(cmd, "pwd") == 0) {
+    handle_pwd(session, json_output);
+  } else if (strcmp(cmd, "get") == 0) {
+    bool resume = take_option(&argc, argv, "--resume", "-c");
+    return handle_get(session, argc > 1 ? argv[1] : NULL,
+                      argc > 2 ? argv[2] : NULL, resume, json_output);
+  } else if (strcmp(cmd, "put") == 0) {
+    bool append = take_option(&argc, argv, "--append", "-a");
+    return handle_put(session, argc > 1 ? argv[1] : NULL,
+                      argc > 2 ? argv[2] : NULL, append, stdin_busy,
+                      json_output);
+  } else if (strcmp(cmd, "mget") == 0 || strcmp(cmd, "mput") == 0) {
+    handle_transfer_many(session, cmd[1] == 'p', argc, argv, json_output);
+  } else if (strcmp(cmd, "mirror") == 0) {
+    return handle_mirror(session, argc, argv, json_output);
+  } else if (strcmp(cmd, "mkdir") == 0) {
+    handle_mkdir(session, argc > 1 ? argv[1] : NULL, json_output);
+  } else {
+    if (json_output) {
+      printf("{\"action\":\"%s\",\"status\":\"error\","
+             "\"message\":\"unknown command\"}\n", cmd);
+    } else {
+      fprintf(stderr, "ftp: unknown command: %s\n", cmd);
+      fprintf(stderr, "Type 'help' for available commands.\n");
+    }
+  }
+  return 0;
+}
+
+
+/**
+ * @brief Read commands and run them until quit or end of input.
+ *
+ * @param session FTP session.
+ * @param in Stream to read commands from.
+ * @param pipe Pipeline for mkdir and cd, or NULL to prompt and run each
+ *        command as it is read.
+ * @param json_output JSON output mode.
+ * @return 0 on normal exit.
+ */
+static int run_commands(ftp_session_t *session, FILE *in, pipeline_t *pipe,
+                        bool json_output) {
   char line[MAX_CMD_LINE];
   char *argv[MAX_ARGS];
   int argc;
+  bool prompt = !pipe && !json_output;
 
-  if (!json_output) {
+  if (prompt) {
     printf("Type 'help' for available commands.\n");
   }
 
   while (1) {
     /* Print prompt */
-    if (!json_output) {
+    if (prompt) {
       printf("ftp> ");
       fflush(stdout);
     }
 
     /* Read command line */
-    if (!fgets(line, sizeof(line), stdin)) {
+    if (!fgets(line, sizeof(line), in)) {
       /* EOF */
-      if (!json_output) {
+      if (prompt) {
         printf("\n");
       }
       break;
@@ -365,48 +913,56 @@ int ftp_interactive(ftp_session_t *session, bool json_output) {
       line[len - 1] = '\0';
     }
 
-    /* Parse arguments */
+    /* Parse arguments; a batch may have comments */
     argc = parse_args(line, argv, MAX_ARGS);
-    if (argc == 0) {
+    if (argc == 0 || (pipe && argv[0][0] == '#')) {
       continue;
     }
 
     const char *cmd = argv[0];
 
-    /* Dispatch command */
-    if (strcmp(cmd, "quit") == 0 || strcmp(cmd, "exit") == 0) {
-      if (json_output) {
-        printf("{\"action\":\"quit\",\"status\":\"ok\"}\n");
-      } else {
-        printf("Goodbye.\n");
-      }
+    /* Queue what can be pipelined; run anything else after it */
+    if (pipe && argc > 1 &&
+        (strcmp(cmd, "mkdir") == 0 || strcmp(cmd, "cd") == 0) &&
+        queue_pipelined(session, pipe, cmd[0] == 'c', argv[1])) {
+      continue;
+    }
+    if (pipe) {
+      flush_pipeline(session, pipe);
+    }
+
+    if (run_command(session, argc, argv, in == stdin, json_output) == 1) {
       break;
-    } else if (strcmp(cmd, "help") == 0 || strcmp(cmd, "?") == 0) {
-      print_help(json_output);
-    } else if (strcmp(cmd, "ls") == 0 || strcmp(cmd, "dir") == 0) {
-      handle_ls(session, argc > 1 ? argv[1] : NULL, json_output);
-    } else if (strcmp(cmd, "cd") == 0) {
-      handle_cd(session, argc > 1 ? argv[1] : NULL, json_output);
-    } else if (strcmp(cmd, "pwd") == 0) {
-      handle_pwd(session, json_output);
-    } else if (strcmp(cmd, "get") == 0) {
-      handle_get(session, argc > 1 ? argv[1] : NULL,
-                 argc > 2 ? argv[2] : NULL, json_output);
-    } else if (strcmp(cmd, "put") == 0) {
-      handle_put(session, argc > 1 ? argv[1] : NULL,
-                 argc > 2 ? argv[2] : NULL, json_output);
-    } else if (strcmp(cmd, "mkdir") == 0) {
-      handle_mkdir(session, argc > 1 ? argv[1] : NULL, json_output);
-    } else {
-      if (json_output) {
-        printf("{\"action\":\"%s\",\"status\":\"error\","
-               "\"message\":\"unknown command\"}\n", cmd);
-      } else {
-        fprintf(stderr, "ftp: unknown command: %s\n", cmd);
-        fprintf(stderr, "Type 'help' for available commands.\n");
-      }
     }
   }
 
+  if (pipe) {
+    flush_pipeline(session, pipe);
+  }
   return 0;
 }
+
+
+int ftp_interactive(ftp_session_t *session, bool json_output) {
+  return run_commands(session, stdin, NULL, json_output);
+}
+
+
+int ftp_batch(ftp_session_t *session, FILE *script, bool json_output) {
+  pipeline_t *pipe = calloc(1, sizeof(*pipe));
+  if (!pipe) return -1;
+  pipe->json_output = json_output;
+
+  int result = run_commands(session, script, pipe, json_output);
+  free(pipe);
+  return result;
+}
+
+
+int ftp_run_one(ftp_session_t *session, int argc, char **argv,
+                bool json_output) {
+  if (argc < 1) return -1;
+  int result = run_command(session, argc, argv, false, json_output);
+  fflush(stdout);
+  return result < 0 ? -1 : 0;
+}
@@ -10,6 +10,7 @@
 
 #include "ftp_client.h"
 #include <stdbool.h>
+#include <stdio.h>
 
 
 /**
@@ -18,10 +19,13 @@
  * Reads commands from stdin and executes them until quit.
  * Supported commands:
  * - ls [path]      - List directory contents
+ * - mls [path]     - List directory entries' facts (MLSD)
  * - cd <path>      - Change directory
  * - pwd            - Print working directory
- * - get <remote> [local] - Download file
- * - put <local> [remote] - Upload file
+ * - get <remote> [local] - Download file ("-" for stdout)
+ * - put <local> [remote] - Upload file ("-" for stdin, with a script)
+ * - mget [-n N] <remote>... - Download files over N sessions
+ * - mput [-n N] <local>...  - Upload files over N sessions
  * - mkdir <dir>    - Create directory
  * - help           - Show available commands
  * - quit/exit      - Disconnect and exit
@@ -33,4 +37,39 @@
 int ftp_interactive(ftp_session_t *session, bool json_output);
 
 
+/**
+ * @brief Run the commands of a script.
+ *
+ * Takes the same commands as ftp_interactive(), one per line, without
+ * prompting; lines starting with '#' are comments. Consecutive mkdir
+ * and cd commands are pipelined, so a long run of them costs a few
+ * round trips rather than one each. Their results are reported in
+ * order, as if each had waited for its reply, before the next command
+ * of another kind runs.
+ *
+ * @param session Pointer to connected and logged-in session.
+ * @param script Stream to read commands from.
+ * @param json_output If true, output results in JSON format.
+ * @return 0 on normal exit, -1 on error.
+ */
+int ftp_batch(ftp_session_t *session, FILE *script, bool json_output);
+
+
+/**
+ * @brief Run a single command given as arguments.
+ *
+ * Takes the same commands as ftp_interactive(). stdin is free, so put
+ * can upload it; "get FILE -" writes FILE to stdout and its report to
+ * stderr, leaving stdout to the data.
+ *
+ * @param session Pointer to connected and logged-in session.
+ * @param argc Number of arguments.
+ * @param argv Command and its arguments; may be reordered.
+ * @param json_output If true, output results in JSON format.
+ * @return 0 on success, -1 if a get or put failed.
+ */
+int ftp_run_one(ftp_session_t *session, int argc, char **argv,
+                bool json_output);
+
+
 #endif /* FTP_INTERACTIVE_H */
@@ -0,0 +1,613 @@
+/**
+ * @file ftp_mirror.c
+ * @brief Keep a local tree and a remote tree alike.
+ *
+ * The trees are walked together one directory at a time: both listings
+ * are sorted by name and merged, so each name is looked at once. Files
+ * to move are only collected during the walk, which needs nothing but
+ * the control connection, and are then moved together by ftp_mget() or
+ * ftp_mput(). Directories are created, and extra entries removed, as the
+ * walk meets them.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+
+#include "ftp_mirror.h"
+#include "ftp_parallel.h"
+
+
+/** Bytes read at a time while hashing a local file. */
+#define MIRROR_HASH_BUFFER (256 * 1024)
+
+/** Most open descriptors while removing a local tree. */
+#define MIRROR_NFTW_FDS 16
+
+
+/** An entry of a directory, on either side. */
+typedef struct {
+  char *name;
+  bool dir;
+  long long size;
+  time_t mtime;                       /**< Modification time, or -1. */
+} mirror_entry_t;
+
+/** The entries of a directory. */
+typedef struct {
+  mirror_entry_t *entries;
+  size_t count;
+  size_t cap;
+} mirror_listing_t;
+
+/** State of one mirror. */
+typedef struct {
+  ftp_session_t *session;
+  const ftp_mirror_opts_t *opts;
+  bool checksum;                      /**< Still comparing by HASH. */
+  ftp_mirror_fn fn;
+  void *ctx;
+  ftp_mirror_stats_t *stats;
+  ftp_transfer_t *files;              /**< Files to move. */
+  long long *sizes;                   /**< Their sizes at the source. */
+  time_t *mtimes;                     /**< Their source times. */
+  char **paths;                       /**< Their paths below the roots. */
+  size_t count;
+  size_t cap;
+  bool out_of_memory;
+} mirror_t;
+
+
+/**
+ * @brief Join a directory and a name.
+ *
+ * @param dir Directory, or "" for none.
+ * @param name Name.
+ * @return The path, to be freed, or NULL if out of memory.
+ */
+static char *join_path(const char *dir, const char *name) {
+  char *path;
+  if (!*dir) return strdup(name);
+  size_t len = strlen(dir);
+  bool slash = dir[len - 1] == '/';
+  if (asprintf(&path, "%s%s%s", dir, slash ? "" : "/", name) < 0) {
+    return NULL;
+  }
+  return path;
+}
+
+
+/**
+ * @brief Add an entry to a listing.
+ *
+ * @param listing Listing.
+ * @param name Name, copied.
+ * @param dir Whether the entry is a directory.
+ * @param size Size in bytes.
+ * @param mtime Modification time, or -1.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int add_entry(mirror_listing_t *listing, const char *name, bool dir,
+                     long long size, time_t mtime) {
+  if (listing->count == listing->cap) {
+    size_t cap = listing->cap ? listing->cap * 2 : 32;
+    mirror_entry_t *grown = realloc(listing->entries,
+                                    cap * sizeof(*grown));
+    if (!grown) return -1;
+    listing->entries = grown;
+    listing->cap = cap;
+  }
+
+  char *copy = strdup(name);
+  if (!copy) return -1;
+  listing->entries[listing->count++] = (mirror_entry_t){
+    .name = copy, .dir = dir, .size = size, .mtime = mtime,
+  };
+  return 0;
+}
+
+
+/**
+ * @brief Free the entries of a listing.
+ *
+ * @param listing Listing; left empty.
+ */
+static void free_listing(mirror_listing_t *listing) {
+  for (size_t i = 0; i < listing->count; i++) {
+    free(listing->entries[i].name);
+  }
+  free(listing->entries);
+  *listing = (mirror_listing_t){0};
+}
+
+
+/**
+ * @brief Order entries by name.
+ */
+static int compare_entries(const void *a, const void *b) {
+  return strcmp(((const mirror_entry_t *)a)->name,
+                ((const mirror_entry_t *)b)->name);
+}
+
+
+/**
+ * @brief Convert an MLSD modify fact to a time.
+ *
+ * @param modify YYYYMMDDHHMMSS in UTC, possibly with fractions.
+ * @return The time, or -1 if there is none.
+ */
+static time_t parse_modify(const char *modify) {
+  struct tm tm = {0};
+  if (strlen(modify) < 14 ||
+      sscanf(modify, "%4d%2d%2d%2d%2d%2d", &tm.tm_year, &tm.tm_mon,
+             &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6) {
+    return -1;
+  }
+  tm.tm_year -= 1900;
+  tm.tm_mon -= 1;
+  return timegm(&tm);
+}
+
+
+/**
+ * @brief Add an entry of an MLSD listing; "." and ".." and anything but
+ *        files and directories are left out.
+ *
+ * @param entry Entry of the listing.
+ * @param ctx The mirror_listing_t being filled.
+ * @return 0 to go on, -1 if out of memory.
+ */
+static int collect_remote(const ftp_entry_t *entry, void *ctx) {
+  bool dir = strcasecmp(entry->type, "dir") == 0;
+  if (!dir && strcasecmp(entry->type, "file") != 0) return 0;
+  if (strcmp(entry->name, ".") == 0 || strcmp(entry->name, "..") == 0) {
+    return 0;
+  }
+  return add_entry(ctx, entry->name, dir, entry->size,
+                   parse_modify(entry->modify));
+}
+
+
+/**
+ * @brief List a local directory; symlinks are followed to files only,
+ *        so the walk cannot loop.
+ *
+ * @param path Directory.
+ * @param listing Filled with the files and directories.
+ * @return 0 on success, -1 with errno set.
+ */
+static int list_local(const char *path, mirror_listing_t *listing) {
+  DIR *dir = opendir(path);
+  if (!dir) return -1;
+
+  struct dirent *de;
+  int rc = 0;
+  while (rc == 0 && (de = readdir(dir)) != NULL) {
+    if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) {
+      continue;
+    }
+    struct stat st;
+    if (fstatat(dirfd(dir), de->d_name, &st, 0) < 0) continue;
+    bool is_dir = S_ISDIR(st.st_mode);
+    if ((is_dir && de->d_type == DT_LNK) ||
+        (!is_dir && !S_ISREG(st.st_mode))) {
+      continue;
+    }
+    rc = add_entry(listing, de->d_name, is_dir, (long long)st.st_size,
+                   st.st_mtime);
+  }
+  int err = errno;
+  closedir(dir);
+  errno = err;
+  return rc;
+}
+
+
+/**
+ * @brief Compute the SHA-256 of a local file.
+ *
+ * @param path File.
+ * @param hex Set to the digest in lower-case hex; 65 bytes.
+ * @return 0 on success, -1 on error.
+ */
+static int hash_local(const char *path, char hex[65]) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return -1;
+
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_len = 0;
+  EVP_MD_CTX *md = EVP_MD_CTX_new();
+  bool ok = md && EVP_DigestInit_ex(md, EVP_sha256(), NULL) == 1;
+  char *buf = ok ? malloc(MIRROR_HASH_BUFFER) : NULL;
+  ok = buf != NULL;
+  ssize_t n;
+  while (ok && (n = read(fd, buf, MIRROR_HASH_BUFFER)) != 0) {
+    ok = n > 0 ? EVP_DigestUpdate(md, buf, (size_t)n) == 1 : errno == EINTR;
+  }
+  ok = ok && EVP_DigestFinal_ex(md, digest, &digest_len) == 1 &&
+       digest_len == 32;
+  free(buf);
+  EVP_MD_CTX_free(md);
+  close(fd);
+  if (!ok) return -1;
+
+  for (unsigned int i = 0; i < digest_len; i++) {
+    snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+  }
+  return 0;
+}
+
+
+/**
+ * @brief Report a change.
+ *
+ * @param m Mirror.
+ * @param op Change.
+ * @param path Path below the roots.
+ * @param message NULL on success, the reason otherwise.
+ */
+static void report(mirror_t *m, const char *op, const char *path,
+                   const char *message) {
+  if (message) m->stats->failed++;
+  if (m->fn) m->fn(op, path, message, m->ctx);
+}
+
+
+/**
+ * @brief Decide whether a file differs between the trees.
+ *
+ * @param m Mirror.
+ * @param src The file at the source.
+ * @param dst The file at the destination.
+ * @param remote_path Remote path of the file.
+ * @param local_path Local path of the file.
+ * @return true if it must be moved.
+ */
+static bool file_differs(mirror_t *m, const mirror_entry_t *src,
+                         const mirror_entry_t *dst, const char *remote_path,
+                         const char *local_path) {
+  if (src->size != dst->size) return true;
+
+  if (m->checksum) {
+    char theirs[65];
+    char ours[65];
+    if (ftp_hash(m->session, remote_path, theirs, sizeof(theirs)) == 0) {
+      return hash_local(local_path, ours) < 0 || strcmp(ours, theirs) != 0;
+    }
+    /* A server without HASH; times will have to do */
+    int code = ftp_last_code(m->session);
+    if (code != 500 && code != 502) return true;
+    m->checksum = false;
+  }
+
+  if (src->mtime < 0 || dst->mtime < 0) return true;
+  return m->opts->push ? src->mtime > dst->mtime : src->mtime != dst->mtime;
+}
+
+
+/**
+ * @brief Collect a file to move.
+ *
+ * @param m Mirror.
+ * @param path Path below the roots; taken over.
+ * @param remote_path Remote path; taken over.
+ * @param local_path Local path; taken over.
+ * @param src The file at the source.
+ */
+static void queue_file(mirror_t *m, char *path, char *remote_path,
+                       char *local_path, const mirror_entry_t *src) {
+  if (m->count == m->cap) {
+    size_t cap = m->cap ? m->cap * 2 : 64;
+    ftp_transfer_t *files = realloc(m->files, cap * sizeof(*files));
+    if (files) m->files = files;
+    long long *sizes = realloc(m->sizes, cap * sizeof(*sizes));
+    if (sizes) m->sizes = sizes;
+    time_t *mtimes = realloc(m->mtimes, cap * sizeof(*mtimes));
+    if (mtimes) m->mtimes = mtimes;
+    char **paths = realloc(m->paths, cap * sizeof(*paths));
+    if (paths) m->paths = paths;
+    if (!files || !sizes || !mtimes || !paths) {
+      m->out_of_memory = true;
+      free(path);
+      free(remote_path);
+      free(local_path);
+      return;
+    }
+    m->cap = cap;
+  }
+
+  m->files[m->count] = (ftp_transfer_t){
+    .remote = remote_path, .local = local_path,
+  };
+  m->sizes[m->count] = src->size;
+  m->mtimes[m->count] = src->mtime;
+  m->paths[m->count] = path;
+  m->count++;
+}
+
+
+/**
+ * @brief Remove a local file or directory, with everything in it.
+ */
+static int remove_local_entry(const char *path, const struct stat *st,
+                              int type, struct FTW *ftw) {
+  (void)st;
+  (void)type;
+  (void)ftw;
+  return remove(path);
+}
+
+
+/**
+ * @brief Remove a remote file or directory, with everything in it.
+ *
+ * @param session FTP session.
+ * @param path Remote path.
+ * @param dir Whether it is a directory.
+ * @return 0 on success, -1 on error.
+ */
+static int remove_remote(ftp_session_t *session, const char *path, bool dir) {
+  if (!dir) return ftp_delete(session, path);
+
+  mirror_listing_t listing = {0};
+  if (ftp_mlsd(session, path, collect_remote, &listing) < 0) {
+    free_listing(&listing);
+    return -1;
+  }
+
+  int rc = 0;
+  for (size_t i = 0; rc == 0 && i < listing.count; i++) {
+    char *child = join_path(path, listing.entries[i].name);
+    rc = child ? remove_remote(session, child, listing.entries[i].dir) : -1;
+    free(child);
+  }
+  free_listing(&listing);
+  return rc == 0 ? ftp_rmdir(session, path) : -1;
+}
+
+
+/**
+ * @brief Remove an entry the source lacks from the destination.
+ *
+ * @param m Mirror.
+ * @param entry The entry at the destination.
+ * @param path Path below the roots.
+ * @param remote_path Remote path.
+ * @param local_path Local path.
+ * @return 0 on success, -1 on error.
+ */
+static int remove_extra(mirror_t *m, const mirror_entry_t *entry,
+                        const char *path, const char *remote_path,
+                        const char *local_path) {
+  int rc;
+  const char *reason;
+  if (m->opts->push) {
+    rc = remove_remote(m->session, remote_path, entry->dir);
+    reason = ftp_last_response(m->session);
+  } else {
+    rc = entry->dir ? nftw(local_path, remove_local_entry, MIRROR_NFTW_FDS,
+                           FTW_DEPTH | FTW_PHYS)
+                    : unlink(local_path);
+    reason = strerror(errno);
+  }
+
+  if (rc < 0) {
+    report(m, "delete", path, reason);
+    return -1;
+  }
+  m->stats->deleted++;
+  report(m, "delete", path, NULL);
+  return 0;
+}
+
+
+/**
+ * @brief Create a directory at the destination.
+ *
+ * @param m Mirror.
+ * @param path Path below the roots, for reporting.
+ * @param remote_path Remote path.
+ * @param local_path Local path.
+ * @return 0 on success, -1 on error.
+ */
+static int make_dir(mirror_t *m, const char *path, const char *remote_path,
+                    const char *local_path) {
+  int rc = m->opts->push ? ftp_mkdir(m->session, remote_path)
+                         : mkdir(local_path, 0755);
+  if (rc < 0) {
+    report(m, "mkdir", path, m->opts->push ? ftp_last_response(m->session)
+                                           : strerror(errno));
+    return -1;
+  }
+  if (*path) report(m, "mkdir", path, NULL);
+  return 0;
+}
+
+
+static void walk(mirror_t *m, const char *path, const char *remote_dir,
+                 const char *local_dir, bool fresh);
+
+
+/**
+ * @brief Bring one name of a directory in line with the source.
+ *
+ * @param m Mirror.
+ * @param dir Path of the directory below the roots.
+ * @param remote_dir Remote directory.
+ * @param local_dir Local directory.
+ * @param src The entry at the source, or NULL.
+ * @param dst The entry at the destination, or NULL.
+ */
+static void sync_entry(mirror_t *m, const char *dir, const char *remote_dir,
+                       const char *local_dir, const mirror_entry_t *src,
+                       const mirror_entry_t *dst) {
+  const char *name = src ? src->name : dst->name;
+  char *path = join_path(dir, name);
+  char *remote_path = join_path(remote_dir, name);
+  char *local_path = join_path(local_dir, name);
+  if (!path || !remote_path || !local_path) {
+    m->out_of_memory = true;
+    goto done;
+  }
+
+  if (dst && (!src || src->dir != dst->dir)) {
+    if (!m->opts->delete_extra) {
+      if (src) report(m, src->dir ? "mkdir" : m->opts->push ? "put" : "get",
+                      path, "in the way; use --delete");
+      goto done;
+    }
+    if (remove_extra(m, dst, path, remote_path, local_path) < 0 || !src) {
+      goto done;
+    }
+    dst = NULL;
+  }
+
+  if (src->dir) {
+    if (dst || make_dir(m, path, remote_path, local_path) == 0) {
+      walk(m, path, remote_path, local_path, !dst);
+    }
+  } else if (!dst || file_differs(m, src, dst, remote_path, local_path)) {
+    queue_file(m, path, remote_path, local_path, src);
+    return;
+  } else {
+    m->stats->unchanged++;
+  }
+
+done:
+  free(path);
+  free(remote_path);
+  free(local_path);
+}
+
+
+/**
+ * @brief Bring a directory, and those below it, in line with the source.
+ *
+ * @param m Mirror.
+ * @param path Path of the directory below the roots; "" at the top.
+ * @param remote_dir Remote directory.
+ * @param local_dir Local directory.
+ * @param fresh Whether the destination was just created, so is empty.
+ */
+static void walk(mirror_t *m, const char *path, const char *remote_dir,
+                 const char *local_dir, bool fresh) {
+  mirror_listing_t remote = {0};
+  mirror_listing_t local = {0};
+  bool push = m->opts->push;
+  mirror_listing_t *src = push ? &local : &remote;
+  mirror_listing_t *dst = push ? &remote : &local;
+
+  int rc = push ? list_local(local_dir, &local)
+                : ftp_mlsd(m->session, remote_dir, collect_remote, &remote);
+  if (rc < 0) {
+    report(m, "list", path, push ? strerror(errno)
+                                 : ftp_last_response(m->session));
+    goto done;
+  }
+  if (!fresh) {
+    rc = push ? ftp_mlsd(m->session, remote_dir, collect_remote, &remote)
+              : list_local(local_dir, &local);
+    if (rc < 0 && !*path) {
+      /* The destination's top may be missing; the source's may not */
+      free_listing(dst);
+      if (make_dir(m, path, remote_dir, local_dir) < 0) goto done;
+    } else if (rc < 0) {
+      report(m, "list", path, push ? ftp_last_response(m->session)
+                                   : strerror(errno));
+      goto done;
+    }
+  }
+
+  if (src->count > 1) {
+    qsort(src->entries, src->count, sizeof(mirror_entry_t), compare_entries);
+  }
+  if (dst->count > 1) {
+    qsort(dst->entries, dst->count, sizeof(mirror_entry_t), compare_entries);
+  }
+
+  size_t i = 0;
+  size_t j = 0;
+  while (!m->out_of_memory && (i < src->count || j < dst->count)) {
+    int order = i == src->count ? 1
+              : j == dst->count ? -1
+              : strcmp(src->entries[i].name, dst->entries[j].name);
+    const mirror_entry_t *s = order <= 0 ? &src->entries[i++] : NULL;
+    const mirror_entry_t *d = order >= 0 ? &dst->entries[j++] : NULL;
+    sync_entry(m, path, remote_dir, local_dir, s, d);
+  }
+
+done:
+  free_listing(&remote);
+  free_listing(&local);
+}
+
+
+int ftp_mirror(ftp_session_t *session, const char *remote, const char *local,
+               const ftp_mirror_opts_t *opts, ftp_mirror_fn fn, void *ctx,
+               ftp_mirror_stats_t *stats) {
+  *stats = (ftp_mirror_stats_t){0};
+  if (!session || !session->logged_in || !remote || !local || !opts) {
+    return -1;
+  }
+
+  mirror_t m = {
+    .session = session,
+    .opts = opts,
+    .checksum = opts->checksum,
+    .fn = fn,
+    .ctx = ctx,
+    .stats = stats,
+  };
+
+  walk(&m, "", remote, local, false);
+
+  /* Move what differs all together */
+  if (m.count > 0) {
+    if (opts->push) {
+      ftp_mput(session, m.files, m.count, opts->connections);
+    } else {
+      ftp_mget(session, m.files, m.count, opts->connections);
+    }
+  }
+
+  for (size_t i = 0; i < m.count; i++) {
+    ftp_transfer_t *file = &m.files[i];
+    if (file->status < 0) {
+      report(&m, opts->push ? "put" : "get", m.paths[i], file->message);
+    } else {
+      /* The next mirror then finds the files alike */
+      if (!opts->push && m.mtimes[i] >= 0) {
+        struct timespec times[2] = {
+          { .tv_sec = m.mtimes[i] }, { .tv_sec = m.mtimes[i] },
+        };
+        utimensat(AT_FDCWD, file->local, times, 0);
+      }
+      stats->transferred++;
+      stats->bytes += m.sizes[i];
+      report(&m, opts->push ? "put" : "get", m.paths[i], NULL);
+    }
+    free((char *)file->remote);
+    free((char *)file->local);
+    free(m.paths[i]);
+  }
+  free(m.files);
+  free(m.sizes);
+  free(m.mtimes);
+  free(m.paths);
+
+  if (m.out_of_memory) {
+    report(&m, "list", "", strerror(ENOMEM));
+  }
+  return stats->failed > 0 ? -1 : 0;
+}
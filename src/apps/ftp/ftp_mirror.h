@@ -0,0 +1,84 @@
+/**
+ * @file ftp_mirror.h
+ * @brief Keep a local tree and a remote tree alike.
+ *
+ * Both trees are listed, the remote one with MLSD, and only the files
+ * that differ are moved, over several sessions at once, so a repeated
+ * mirror moves bytes in proportion to what changed rather than to the
+ * size of the tree.
+ */
+
+#ifndef FTP_MIRROR_H
+#define FTP_MIRROR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "ftp_client.h"
+
+
+/**
+ * @brief How to mirror.
+ */
+typedef struct {
+  bool push;                          /**< Make the remote tree like the
+                                           local one, not the reverse. */
+  bool delete_extra;                  /**< Remove what the source lacks. */
+  bool checksum;                      /**< Compare files of equal size by
+                                           SHA-256 (HASH) rather than by
+                                           time. */
+  int connections;                    /**< Sessions to move files over. */
+} ftp_mirror_opts_t;
+
+
+/**
+ * @brief What a mirror did.
+ */
+typedef struct {
+  size_t unchanged;                   /**< Files already alike. */
+  size_t transferred;                 /**< Files moved. */
+  size_t deleted;                     /**< Files and directories removed. */
+  size_t failed;                      /**< Changes that failed. */
+  long long bytes;                    /**< Bytes of the files moved. */
+} ftp_mirror_stats_t;
+
+
+/**
+ * @brief Called for each change once it is made or has failed.
+ *
+ * @param op "get", "put", "mkdir", "delete", or "list" for a directory
+ *        that could not be listed.
+ * @param path Path below the mirrored directories.
+ * @param message NULL on success, the reason otherwise.
+ * @param ctx Caller's context.
+ */
+typedef void (*ftp_mirror_fn)(const char *op, const char *path,
+                              const char *message, void *ctx);
+
+
+/**
+ * @brief Make one directory tree like another.
+ *
+ * A file is moved when the other side lacks it or its size differs.
+ * Otherwise, with opts->checksum and a server that knows HASH, it is
+ * moved when the digests differ; without, a download is moved when the
+ * times differ and an upload when the local file is newer. Downloaded
+ * files take the remote time, so the next mirror finds them alike.
+ * Missing directories are created on the way.
+ *
+ * @param session Pointer to logged-in session.
+ * @param remote Remote directory.
+ * @param local Local directory.
+ * @param opts How to mirror.
+ * @param fn Called for each change, or NULL.
+ * @param ctx Passed to fn.
+ * @param stats Set to what was done.
+ * @return 0 if every change was made, -1 otherwise (the source could
+ *         not be listed, or a change failed).
+ */
+int ftp_mirror(ftp_session_t *session, const char *remote, const char *local,
+               const ftp_mirror_opts_t *opts, ftp_mirror_fn fn, void *ctx,
+               ftp_mirror_stats_t *stats);
+
+
+#endif /* FTP_MIRROR_H */
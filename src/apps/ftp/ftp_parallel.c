@@ -0,0 +1,369 @@
+/**
+ * @file ftp_parallel.c
+ * @brief Parallel FTP transfers over several sessions.
+ *
+ * Files wait in a queue shared by one thread per session; the session
+ * the transfer was started from is served by the calling thread. A file
+ * fetched in segments is opened once, given its full size with
+ * ftruncate(), and written with pwrite() by every session fetching a
+ * part of it. Its segments go to the front of the queue, so the idle
+ * sessions take them before starting other files.
+ *
+ * Over TLS the additional sessions resume the first one's TLS session,
+ * so they log in without a full handshake.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ftp_parallel.h"
+
+
+struct ftp_split;
+
+/** A file, or a segment of one, waiting for a session. */
+typedef struct ftp_job {
+  ftp_transfer_t *file;
+  struct ftp_split *split;            /**< File of a segment, or NULL. */
+  off_t offset;                       /**< First byte of a segment. */
+  off_t length;                       /**< Length of a segment. */
+  struct ftp_job *next;
+} ftp_job_t;
+
+/** A file being fetched in segments. */
+typedef struct ftp_split {
+  int fd;                             /**< Local file, open for writing. */
+  int pending;                        /**< Segments not yet finished. */
+  bool failed;
+  ftp_job_t segments[];
+} ftp_split_t;
+
+/** State shared by the sessions of one transfer. */
+typedef struct {
+  ftp_session_t *session;             /**< Session the transfer began on. */
+  char cwd[1024];                     /**< Its remote directory. */
+  bool upload;
+  int connections;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  ftp_job_t *jobs;                    /**< Queue of jobs. */
+  int sizing;                         /**< Files being sized, which may
+                                           still add segments. */
+  struct ssl_session_st *ticket;      /**< TLS session for the others to
+                                           resume, or NULL. */
+} ftp_batch_t;
+
+/** An additional session and its thread. */
+typedef struct {
+  ftp_batch_t *batch;
+  ftp_session_t session;
+  pthread_t thread;
+} ftp_worker_t;
+
+
+/**
+ * @brief Record why a file failed.
+ *
+ * @param file File that failed.
+ * @param message Reason.
+ */
+static void fail_file(ftp_transfer_t *file, const char *message) {
+  file->status = -1;
+  snprintf(file->message, sizeof(file->message), "%s", message);
+}
+
+
+/**
+ * @brief Take the next job, waiting while a file being sized may add
+ *        segments.
+ *
+ * @param batch Transfer.
+ * @return Job, or NULL once there are none left.
+ */
+static ftp_job_t *next_job(ftp_batch_t *batch) {
+  pthread_mutex_lock(&batch->lock);
+  while (!batch->jobs && batch->sizing > 0) {
+    pthread_cond_wait(&batch->cond, &batch->lock);
+  }
+
+  ftp_job_t *job = batch->jobs;
+  if (job) {
+    batch->jobs = job->next;
+    if (!job->split && !batch->upload) batch->sizing++;
+  }
+  pthread_mutex_unlock(&batch->lock);
+  return job;
+}
+
+
+/**
+ * @brief Open a local file for fetching in segments and queue all its
+ *        segments but the first.
+ *
+ * @param batch Transfer.
+ * @param file File to fetch.
+ * @param size Size of the remote file.
+ * @param parts Number of segments.
+ * @return The file, or NULL if it could not be set up.
+ */
+static ftp_split_t *start_split(ftp_batch_t *batch, ftp_transfer_t *file,
+                                off_t size, int parts) {
+  ftp_split_t *split = malloc(sizeof(*split) +
+                              (size_t)parts * sizeof(split->segments[0]));
+  if (!split) return NULL;
+
+  split->fd = open(file->local, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                   0644);
+  if (split->fd < 0 || ftruncate(split->fd, size) < 0) {
+    if (split->fd >= 0) close(split->fd);
+    free(split);
+    return NULL;
+  }
+  split->pending = parts;
+  split->failed = false;
+
+  off_t part = size / parts;
+  for (int i = 0; i < parts; i++) {
+    ftp_job_t *job = &split->segments[i];
+    job->file = file;
+    job->split = split;
+    job->offset = part * i;
+    job->length = i == parts - 1 ? size - job->offset : part;
+    job->next = i < parts - 1 ? &split->segments[i + 1] : NULL;
+  }
+
+  /* The caller fetches the first; the rest go to the front */
+  pthread_mutex_lock(&batch->lock);
+  ftp_job_t *last = &split->segments[parts - 1];
+  last->next = batch->jobs;
+  batch->jobs = &split->segments[1];
+  pthread_mutex_unlock(&batch->lock);
+
+  return split;
+}
+
+
+/**
+ * @brief Fetch one segment of a file; the last segment to finish
+ *        closes the file.
+ *
+ * @param batch Transfer.
+ * @param session Session to use.
+ * @param job Segment.
+ */
+static void fetch_segment(ftp_batch_t *batch, ftp_session_t *session,
+                          ftp_job_t *job) {
+  ftp_split_t *split = job->split;
+  ftp_transfer_t *file = job->file;
+
+  int rc = ftp_get_range(session, file->remote, split->fd, job->offset,
+                         job->length);
+
+  pthread_mutex_lock(&batch->lock);
+  if (rc < 0 && !split->failed) {
+    split->failed = true;
+    fail_file(file, ftp_last_response(session));
+  }
+  bool last = --split->pending == 0;
+  pthread_mutex_unlock(&batch->lock);
+  if (!last) return;
+
+  if (close(split->fd) < 0 && !split->failed) {
+    split->failed = true;
+    fail_file(file, strerror(errno));
+  }
+  if (split->failed) {
+    /* A file with holes in it must not pass for a partial download */
+    unlink(file->local);
+  } else {
+    file->status = 0;
+  }
+  free(split);
+}
+
+
+/**
+ * @brief Fetch a file, in segments if it is large enough.
+ *
+ * @param batch Transfer.
+ * @param session Session to use.
+ * @param job File.
+ */
+static void fetch_file(ftp_batch_t *batch, ftp_session_t *session,
+                       ftp_job_t *job) {
+  ftp_transfer_t *file = job->file;
+  ftp_split_t *split = NULL;
+
+  off_t size;
+  if (batch->connections > 1 &&
+      ftp_size(session, file->remote, &size) == 0 &&
+      size >= 2 * (off_t)FTP_SEGMENT_MIN) {
+    off_t parts = size / FTP_SEGMENT_MIN;
+    if (parts > batch->connections) parts = batch->connections;
+    split = start_split(batch, file, size, (int)parts);
+  }
+
+  pthread_mutex_lock(&batch->lock);
+  batch->sizing--;
+  pthread_cond_broadcast(&batch->cond);
+  pthread_mutex_unlock(&batch->lock);
+
+  if (split) {
+    fetch_segment(batch, session, &split->segments[0]);
+  } else if (ftp_get(session, file->remote, file->local, false) < 0) {
+    fail_file(file, ftp_last_response(session));
+  } else {
+    file->status = 0;
+  }
+}
+
+
+/**
+ * @brief Run jobs on a session until there are none left.
+ *
+ * @param batch Transfer.
+ * @param session Session to use.
+ */
+static void run_jobs(ftp_batch_t *batch, ftp_session_t *session) {
+  ftp_job_t *job;
+  while ((job = next_job(batch)) != NULL) {
+    if (job->split) {
+      fetch_segment(batch, session, job);
+    } else if (!batch->upload) {
+      fetch_file(batch, session, job);
+    } else if (ftp_put(session, job->file->local, job->file->remote,
+                       false) < 0) {
+      fail_file(job->file, ftp_last_response(session));
+    } else {
+      job->file->status = 0;
+    }
+  }
+}
+
+
+/**
+ * @brief Thread of an additional session: log in like the first one,
+ *        then run jobs.
+ *
+ * @param arg Worker.
+ * @return NULL.
+ */
+static void *worker_main(void *arg) {
+  ftp_worker_t *worker = arg;
+  ftp_batch_t *batch = worker->batch;
+  ftp_session_t *session = &worker->session;
+
+  ftp_session_init(session);
+  session->passive = batch->session->passive;
+  session->tls_verify = batch->session->tls_verify;
+  memcpy(session->tls_ca, batch->session->tls_ca, sizeof(session->tls_ca));
+
+  /* A session that cannot log in leaves its share to the others */
+  if (ftp_connect(session, batch->session->host, batch->session->port) < 0) {
+    return NULL;
+  }
+  if ((batch->session->tls && ftp_auth_tls(session, batch->ticket) < 0) ||
+      ftp_login(session, batch->session->user) < 0 ||
+      (batch->session->mode_z && ftp_mode_z(session, true) < 0) ||
+      (batch->cwd[0] && ftp_cd(session, batch->cwd) < 0)) {
+    ftp_quit(session);
+    return NULL;
+  }
+
+  run_jobs(batch, session);
+  ftp_quit(session);
+  return NULL;
+}
+
+
+/**
+ * @brief Move files over several sessions at once.
+ *
+ * @param session Pointer to logged-in session.
+ * @param files Files to move.
+ * @param count Number of files.
+ * @param connections Number of sessions.
+ * @param upload true to upload, false to download.
+ * @return 0 if every file was moved, -1 otherwise.
+ */
+static int transfer(ftp_session_t *session, ftp_transfer_t *files,
+                    size_t count, int connections, bool upload) {
+  if (!session || !session->logged_in || (!files && count > 0)) return -1;
+
+  if (connections < 1) connections = 1;
+  if (connections > FTP_PARALLEL_MAX) connections = FTP_PARALLEL_MAX;
+  /* Uploads are never split, so more sessions than files is waste */
+  if (upload && (size_t)connections > count) connections = (int)count;
+  if (count == 0) return 0;
+
+  ftp_job_t *jobs = calloc(count, sizeof(*jobs));
+  ftp_worker_t *workers = calloc((size_t)connections, sizeof(*workers));
+  if (!jobs || !workers) {
+    free(jobs);
+    free(workers);
+    return -1;
+  }
+
+  ftp_batch_t batch = {
+    .session = session,
+    .upload = upload,
+    .connections = connections,
+  };
+  pthread_mutex_init(&batch.lock, NULL);
+  pthread_cond_init(&batch.cond, NULL);
+  if (ftp_pwd(session, batch.cwd, sizeof(batch.cwd)) < 0) batch.cwd[0] = '\0';
+  /* Taken now: the first session's own transfers replace its session */
+  batch.ticket = ftp_tls_ticket(session);
+
+  for (size_t i = 0; i < count; i++) {
+    fail_file(&files[i], "not transferred");
+    jobs[i].file = &files[i];
+    jobs[i].next = i + 1 < count ? &jobs[i + 1] : NULL;
+  }
+  batch.jobs = &jobs[0];
+
+  /* The first session is this one; start the others beside it */
+  int started = 0;
+  for (int i = 1; i < connections; i++) {
+    workers[started].batch = &batch;
+    if (pthread_create(&workers[started].thread, NULL, worker_main,
+                       &workers[started]) == 0) {
+      started++;
+    }
+  }
+
+  run_jobs(&batch, session);
+
+  for (int i = 0; i < started; i++) {
+    pthread_join(workers[i].thread, NULL);
+  }
+
+  ftp_tls_ticket_free(batch.ticket);
+  pthread_cond_destroy(&batch.cond);
+  pthread_mutex_destroy(&batch.lock);
+  free(workers);
+  free(jobs);
+
+  int result = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (files[i].status < 0) result = -1;
+  }
+  return result;
+}
+
+
+int ftp_mget(ftp_session_t *session, ftp_transfer_t *files, size_t count,
+             int connections) {
+  return transfer(session, files, count, connections, false);
+}
+
+
+int ftp_mput(ftp_session_t *session, ftp_transfer_t *files, size_t count,
+             int connections) {
+  return transfer(session, files, count, connections, true);
+}
@@ -0,0 +1,75 @@
+/**
+ * @file ftp_parallel.h
+ * @brief Parallel FTP transfers over several sessions.
+ *
+ * On a link with a long round trip a single data connection spends most
+ * of its time waiting: each file costs several round trips of commands,
+ * and TCP needs many more to open its window. Moving files over several
+ * sessions at once, each with its own control and data connection,
+ * overlaps those waits.
+ */
+
+#ifndef FTP_PARALLEL_H
+#define FTP_PARALLEL_H
+
+#include <stddef.h>
+
+#include "ftp_client.h"
+
+/** Default number of sessions for mget and mput. */
+#define FTP_PARALLEL_DEFAULT 4
+
+/** Most sessions for one mget or mput. */
+#define FTP_PARALLEL_MAX 16
+
+/** Smallest part of a file fetched by a session of its own. */
+#define FTP_SEGMENT_MIN (8 * 1024 * 1024)
+
+
+/**
+ * @brief One file of a parallel transfer.
+ */
+typedef struct {
+  const char *remote;                 /**< Remote filename. */
+  const char *local;                  /**< Local filename. */
+  int status;                         /**< 0 once moved, -1 on error. */
+  char message[FTP_RESPONSE_MAX];     /**< Reason for an error. */
+} ftp_transfer_t;
+
+
+/**
+ * @brief Download files over several sessions at once.
+ *
+ * The session given is one of them; the others log in to the same
+ * server as the same user and change to its current directory. Each
+ * session takes the next file when it is done with one. A file of at
+ * least twice FTP_SEGMENT_MIN is split into up to one segment per
+ * session, fetched at once with ftp_get_range().
+ *
+ * @param session Pointer to logged-in session.
+ * @param files Files to download; status and message are set for each.
+ * @param count Number of files.
+ * @param connections Number of sessions, from 1 to FTP_PARALLEL_MAX.
+ * @return 0 if every file was downloaded, -1 otherwise.
+ */
+int ftp_mget(ftp_session_t *session, ftp_transfer_t *files, size_t count,
+             int connections);
+
+
+/**
+ * @brief Upload files over several sessions at once.
+ *
+ * Works like ftp_mget(), except that each file goes over one session:
+ * a STOR replaces the whole remote file, so it cannot be sent in parts.
+ *
+ * @param session Pointer to logged-in session.
+ * @param files Files to upload; status and message are set for each.
+ * @param count Number of files.
+ * @param connections Number of sessions, from 1 to FTP_PARALLEL_MAX.
+ * @return 0 if every file was uploaded, -1 otherwise.
+ */
+int ftp_mput(ftp_session_t *session, ftp_transfer_t *files, size_t count,
+             int connections);
+
+
+#endif /* FTP_PARALLEL_H */
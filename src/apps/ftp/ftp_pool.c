@@ -0,0 +1,488 @@
+/**
+ * @file ftp_pool.c
+ * @brief Logged-in sessions kept between ftp commands.
+ *
+ * A request to the keeper is one line on a connection of its own, with
+ * the control connection attached to KEEP:
+ *
+ *   TAKE <port> <user> <host>
+ *   KEEP <idle> <port> <mode_z> <user> <host> <home>
+ *
+ * TAKE is answered with "OK <mode_z> <home>" and the connection, or
+ * with "NONE". The keeper is a fork of the command that first hands a
+ * session over, and holds that session from the start.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "ftp_pool.h"
+
+
+/** Longest request or reply line. */
+#define FTP_POOL_LINE 1024
+
+/** How long the keeper waits for a request, in seconds. */
+#define FTP_POOL_TIMEOUT 2
+
+
+/** A session held by the keeper. */
+typedef struct {
+  int fd;                             /**< Control connection. */
+  uint16_t port;                      /**< Server control port. */
+  bool mode_z;                        /**< Whether MODE Z is on. */
+  int idle;                           /**< Seconds it may be held. */
+  long long until;                    /**< When it is quit, in ms. */
+  char host[256];                     /**< Server name. */
+  char user[64];                      /**< User logged in. */
+  char home[FTP_RESPONSE_MAX];        /**< Directory logged in to. */
+} ftp_pooled_t;
+
+
+/**
+ * @brief Current time of the monotonic clock.
+ *
+ * @return Milliseconds.
+ */
+static long long now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/**
+ * @brief Address of the user's keeper socket.
+ *
+ * @param addr Address to fill in.
+ * @return 0 on success, -1 if the path is too long.
+ */
+static int pool_addr(struct sockaddr_un *addr) {
+  const char *dir = getenv("TMPDIR");
+  if (!dir || !*dir) dir = "/tmp";
+
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  int n = snprintf(addr->sun_path, sizeof(addr->sun_path),
+                   "%s/jbox-ftp-%u.sock", dir, (unsigned)getuid());
+  return n > 0 && (size_t)n < sizeof(addr->sun_path) ? 0 : -1;
+}
+
+
+/**
+ * @brief Whether the other end of a Unix socket is the same user.
+ *
+ * @param sock Connected socket.
+ * @return true if so.
+ */
+static bool same_user(int sock) {
+  struct ucred peer;
+  socklen_t len = sizeof(peer);
+  return getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &peer, &len) == 0 &&
+         peer.uid == getuid();
+}
+
+
+/**
+ * @brief Send a line, with a descriptor attached if given.
+ *
+ * @param sock Connected socket.
+ * @param line Line, with its newline.
+ * @param fd Descriptor to pass, or -1.
+ * @return 0 on success, -1 on error.
+ */
+static int send_line(int sock, const char *line, int fd) {
+  union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov = { .iov_base = (void *)line, .iov_len = strlen(line) };
+  struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+  if (fd >= 0) {
+    memset(&control, 0, sizeof(control));
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(c), &fd, sizeof(int));
+  }
+
+  ssize_t n;
+  do {
+    n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+  } while (n < 0 && errno == EINTR);
+  return n == (ssize_t)iov.iov_len ? 0 : -1;
+}
+
+
+/**
+ * @brief Receive a line, and the descriptor attached to it if any.
+ *
+ * @param sock Connected socket.
+ * @param line Set to the line, without its newline.
+ * @param size Size of line.
+ * @param fd Set to the descriptor passed, or -1.
+ * @return 0 on success, -1 on error.
+ */
+static int recv_line(int sock, char *line, size_t size, int *fd) {
+  union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov = { .iov_base = line, .iov_len = size - 1 };
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control.buf,
+    .msg_controllen = sizeof(control.buf)
+  };
+
+  *fd = -1;
+  ssize_t n;
+  do {
+    n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  } while (n < 0 && errno == EINTR);
+
+  struct cmsghdr *c = n >= 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+  if (c && c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS &&
+      c->cmsg_len == CMSG_LEN(sizeof(int))) {
+    memcpy(fd, CMSG_DATA(c), sizeof(int));
+  }
+  if (n <= 0 || line[n - 1] != '\n') {
+    if (*fd >= 0) close(*fd);
+    *fd = -1;
+    return -1;
+  }
+  line[n - 1] = '\0';
+  return 0;
+}
+
+
+/**
+ * @brief Connect to the user's keeper.
+ *
+ * @return Connected socket, or -1 if no keeper is running.
+ */
+static int connect_keeper(void) {
+  struct sockaddr_un addr;
+  if (pool_addr(&addr) < 0) return -1;
+
+  int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0) return -1;
+  if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      !same_user(sock)) {
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+
+/**
+ * @brief Quit a held session and close it.
+ *
+ * @param entry Session.
+ */
+static void quit_pooled(ftp_pooled_t *entry) {
+  static const char quit[] = "QUIT\r\n";
+  send(entry->fd, quit, sizeof(quit) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+  close(entry->fd);
+}
+
+
+/**
+ * @brief Answer one request to the keeper.
+ *
+ * @param sock Accepted connection.
+ * @param pool Held sessions, oldest first.
+ * @param count Number of sessions in pool; updated.
+ */
+static void serve_request(int sock, ftp_pooled_t *pool, int *count) {
+  if (!same_user(sock)) return;
+
+  struct timeval timeout = { .tv_sec = FTP_POOL_TIMEOUT };
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  char line[FTP_POOL_LINE];
+  int fd;
+  if (recv_line(sock, line, sizeof(line), &fd) < 0) return;
+
+  ftp_pooled_t entry = { .fd = fd };
+  int mode_z, home_at = 0;
+  if (fd >= 0 &&
+      sscanf(line, "KEEP %d %hu %d %63s %255s %n", &entry.idle, &entry.port,
+             &mode_z, entry.user, entry.host, &home_at) == 5 &&
+      home_at > 0 && entry.idle > 0) {
+    snprintf(entry.home, sizeof(entry.home), "%s", line + home_at);
+    entry.mode_z = mode_z != 0;
+    entry.until = now_ms() + (long long)entry.idle * 1000;
+    if (*count == FTP_POOL_MAX) {
+      quit_pooled(&pool[0]);
+      memmove(&pool[0], &pool[1], (size_t)--*count * sizeof(pool[0]));
+    }
+    pool[(*count)++] = entry;
+    return;
+  }
+  if (fd >= 0) close(fd);
+
+  /* The session kept last is the likeliest to be alive */
+  if (sscanf(line, "TAKE %hu %63s %255s", &entry.port, entry.user,
+             entry.host) == 3) {
+    for (int i = *count - 1; i >= 0; i--) {
+      if (pool[i].port != entry.port || strcmp(pool[i].user, entry.user) ||
+          strcmp(pool[i].host, entry.host)) {
+        continue;
+      }
+      char reply[FTP_POOL_LINE];
+      snprintf(reply, sizeof(reply), "OK %d %s\n", pool[i].mode_z,
+               pool[i].home);
+      if (send_line(sock, reply, pool[i].fd) < 0) return;
+      close(pool[i].fd);
+      memmove(&pool[i], &pool[i + 1], (size_t)(*count - i - 1) *
+              sizeof(pool[0]));
+      (*count)--;
+      return;
+    }
+    send_line(sock, "NONE\n", -1);
+  }
+}
+
+
+/**
+ * @brief Run the keeper until it has held nothing for a while.
+ *
+ * @param listen_fd Keeper socket.
+ * @param path Path of the socket, removed on exit.
+ * @param first Session the keeper starts with.
+ */
+static void run_keeper(int listen_fd, const char *path, ftp_pooled_t *first) {
+  static ftp_pooled_t pool[FTP_POOL_MAX];
+  struct pollfd fds[FTP_POOL_MAX + 1];
+  int count = 0;
+  pool[count++] = *first;
+  int linger = first->idle;
+  long long empty_until = 0;
+
+  for (;;) {
+    /* Quit the sessions held too long */
+    long long now = now_ms();
+    long long next = -1;
+    for (int i = 0; i < count; i++) {
+      if (pool[i].until <= now) {
+        quit_pooled(&pool[i]);
+        memmove(&pool[i], &pool[i + 1], (size_t)(count - i - 1) *
+                sizeof(pool[0]));
+        count--;
+        i--;
+      } else if (next < 0 || pool[i].until < next) {
+        next = pool[i].until;
+      }
+    }
+    if (count == 0) {
+      if (empty_until == 0) empty_until = now + (long long)linger * 1000;
+      if (now >= empty_until) break;
+      next = empty_until;
+    } else {
+      empty_until = 0;
+    }
+
+    fds[0] = (struct pollfd){ .fd = listen_fd, .events = POLLIN };
+    for (int i = 0; i < count; i++) {
+      fds[i + 1] = (struct pollfd){ .fd = pool[i].fd, .events = POLLIN };
+    }
+    int rc = poll(fds, (nfds_t)count + 1, (int)(next - now));
+    if (rc < 0 && errno != EINTR) break;
+    if (rc <= 0) continue;
+
+    /* A server speaking to an idle session is closing it */
+    int held = count;
+    for (int i = held - 1; i >= 0; i--) {
+      if (fds[i + 1].revents) {
+        close(pool[i].fd);
+        memmove(&pool[i], &pool[i + 1], (size_t)(count - i - 1) *
+                sizeof(pool[0]));
+        count--;
+      }
+    }
+
+    if (fds[0].revents & POLLIN) {
+      int sock = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+      if (sock >= 0) {
+        serve_request(sock, pool, &count);
+        close(sock);
+        if (count > 0 && pool[count - 1].idle > linger) {
+          linger = pool[count - 1].idle;
+        }
+      }
+    }
+  }
+
+  unlink(path);
+  close(listen_fd);
+}
+
+
+/**
+ * @brief Become the keeper, in a child forked for it.
+ *
+ * @param first Session the keeper starts with; its descriptor is the
+ *        one this process inherited.
+ */
+static void become_keeper(ftp_pooled_t *first) {
+  setsid();
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGHUP, SIG_IGN);
+
+  /* Hold nothing of the command's open: a pipe it writes to must close */
+  int null_fd = open("/dev/null", O_RDWR);
+  if (null_fd >= 0) {
+    dup2(null_fd, STDIN_FILENO);
+    dup2(null_fd, STDOUT_FILENO);
+    dup2(null_fd, STDERR_FILENO);
+  }
+  long max_fd = sysconf(_SC_OPEN_MAX);
+  if (max_fd < 0 || max_fd > 65536) max_fd = 65536;
+  for (int fd = STDERR_FILENO + 1; fd < max_fd; fd++) {
+    if (fd != first->fd) close(fd);
+  }
+
+  struct sockaddr_un addr;
+  int sock = pool_addr(&addr) == 0
+             ? socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0) : -1;
+  if (sock < 0) {
+    quit_pooled(first);
+    return;
+  }
+
+  /* No keeper answered, so a socket left at the path is stale */
+  unlink(addr.sun_path);
+  if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      chmod(addr.sun_path, S_IRUSR | S_IWUSR) < 0 ||
+      listen(sock, 16) < 0) {
+    close(sock);
+    quit_pooled(first);
+    return;
+  }
+  run_keeper(sock, addr.sun_path, first);
+}
+
+
+/** Replies to the checks of a session taken from the pool. */
+typedef struct {
+  int codes[2];
+} take_check_t;
+
+
+/**
+ * @brief Record the reply to a check.
+ *
+ * @param index Index of the check.
+ * @param code Reply code, or -1.
+ * @param response Reply text (unused).
+ * @param ctx The take_check_t.
+ */
+static void on_check(int index, int code, const char *response, void *ctx) {
+  (void)response;
+  take_check_t *check = ctx;
+  check->codes[index] = code;
+}
+
+
+int ftp_pool_take(ftp_session_t *session, const char *host, uint16_t port,
+                  const char *user, char *home, size_t homesize) {
+  if (!session || !host || !user || session->connected) return -1;
+
+  int sock = connect_keeper();
+  if (sock < 0) return -1;
+
+  char line[FTP_POOL_LINE];
+  int fd = -1, mode_z = 0, home_at = 0;
+  snprintf(line, sizeof(line), "TAKE %u %s %s\n", port, user, host);
+  if (send_line(sock, line, -1) < 0 ||
+      recv_line(sock, line, sizeof(line), &fd) < 0 || fd < 0 ||
+      sscanf(line, "OK %d %n", &mode_z, &home_at) != 1 || home_at == 0) {
+    if (fd >= 0) close(fd);
+    close(sock);
+    return -1;
+  }
+  close(sock);
+
+  session->ctrl_fd = fd;
+  session->connected = true;
+  session->logged_in = true;
+  session->mode_z = mode_z != 0;
+  snprintf(session->host, sizeof(session->host), "%s", host);
+  session->port = port;
+  snprintf(session->user, sizeof(session->user), "%s", user);
+  snprintf(home, homesize, "%s", line + home_at);
+
+  /* One round trip proves the session alive and puts it back home */
+  char cwd[FTP_RESPONSE_MAX];
+  snprintf(cwd, sizeof(cwd), "CWD %s", home);
+  const char *cmds[] = { "NOOP", cwd };
+  take_check_t check = { { -1, -1 } };
+  if (ftp_pipeline(session, cmds, 2, on_check, &check) < 0 ||
+      check.codes[0] != 200 || check.codes[1] != 250) {
+    ftp_close(session);
+    return -1;
+  }
+  return 0;
+}
+
+
+int ftp_pool_give(ftp_session_t *session, const char *home, int idle) {
+  if (!session || !session->logged_in || session->tls || !home || !*home ||
+      idle <= 0 || session->data_fd >= 0 || session->data_listen_fd >= 0 ||
+      session->ctrl_pos < session->ctrl_len) {
+    return -1;
+  }
+
+  ftp_pooled_t entry = {
+    .fd = session->ctrl_fd,
+    .port = session->port,
+    .mode_z = session->mode_z,
+    .idle = idle
+  };
+  snprintf(entry.host, sizeof(entry.host), "%s", session->host);
+  snprintf(entry.user, sizeof(entry.user), "%s", session->user);
+  snprintf(entry.home, sizeof(entry.home), "%s", home);
+
+  int sock = connect_keeper();
+  if (sock >= 0) {
+    char line[FTP_POOL_LINE];
+    snprintf(line, sizeof(line), "KEEP %d %u %d %s %s %s\n", idle,
+             entry.port, entry.mode_z, entry.user, entry.host, entry.home);
+    int rc = send_line(sock, line, entry.fd);
+    close(sock);
+    if (rc < 0) return -1;
+    ftp_close(session);
+    return 0;
+  }
+
+  /* No keeper yet: fork one that holds this session from the start */
+  pid_t pid = fork();
+  if (pid < 0) return -1;
+  if (pid == 0) {
+    entry.until = now_ms() + (long long)idle * 1000;
+    become_keeper(&entry);
+    _exit(0);
+  }
+  ftp_close(session);
+  return 0;
+}
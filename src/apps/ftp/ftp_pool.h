@@ -0,0 +1,66 @@
+/**
+ * @file ftp_pool.h
+ * @brief Logged-in sessions kept between ftp commands.
+ *
+ * A script running one ftp command per file pays for a connection, the
+ * server's greeting and a login every time. With the pool, a command
+ * done with its session hands the control connection to a keeper
+ * process of the user's instead of quitting, and the next command for
+ * the same server, port and user takes it back and carries on.
+ *
+ * The keeper is started by the first command to hand a session over,
+ * listens on a Unix socket in TMPDIR (or /tmp) that only its user may
+ * use, and passes connections with SCM_RIGHTS. It quits a session idle
+ * for longer than the command asked, or that the server closed, and
+ * exits once it has held none for that long.
+ *
+ * A session taken from the pool is checked with NOOP and returned to the
+ * directory it logged in to, both pipelined, so reuse costs one round
+ * trip. TLS sessions are not pooled: their state lives in the process
+ * that made them.
+ */
+
+#ifndef FTP_POOL_H
+#define FTP_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ftp_client.h"
+
+/** Most sessions a keeper holds; the longest held goes beyond that. */
+#define FTP_POOL_MAX 32
+
+
+/**
+ * @brief Take a kept session to a server, if the keeper has one.
+ *
+ * @param session Pointer to initialized, unconnected session; logged in
+ *        on success.
+ * @param host Server name, as given to ftp_connect().
+ * @param port Server control port.
+ * @param user User name, as given to ftp_login().
+ * @param home Set to the directory the session logged in to.
+ * @param homesize Size of home.
+ * @return 0 if a live session was taken, -1 if there is none.
+ */
+int ftp_pool_take(ftp_session_t *session, const char *host, uint16_t port,
+                  const char *user, char *home, size_t homesize);
+
+
+/**
+ * @brief Hand a logged-in session to the keeper instead of quitting,
+ *        starting the keeper if it is not running.
+ *
+ * On success the session is closed here, without QUIT.
+ *
+ * @param session Pointer to logged-in session, with no data connection
+ *        and no reply left unread.
+ * @param home Directory the session logged in to.
+ * @param idle Seconds the keeper may hold the session unused.
+ * @return 0 if handed over, -1 if not, and the session is still open.
+ */
+int ftp_pool_give(ftp_session_t *session, const char *home, int idle);
+
+
+#endif /* FTP_POOL_H */
@@ -0,0 +1,757 @@
+/**
+ * @file cmd_hashsum.c
+ * @brief Hashsum command implementation for jshell.
+ *
+ * Prints or checks SHA-256 and BLAKE3 digests of files, like sha256sum
+ * and b3sum. Regular files are mapped and hashed by a pool of threads:
+ * each SHA-256 file is one job, since SHA-256 cannot be split, while a
+ * large BLAKE3 file is cut into 1 MiB subtrees that the threads hash in
+ * parallel, leaving only the last piece and the root of the tree to the
+ * thread that prints. Digests are printed in the order the files were
+ * named, each as soon as it and the files before it are done; the
+ * printing thread takes jobs itself while it waits. Inputs that cannot be
+ * mapped (standard input, pipes, empty files) are read on the printing
+ * thread through jbox_aio when their turn comes.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "argtable3.h"
+#include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_aio.h"
+#include "utils/jbox_ctx.h"
+#include "utils/jbox_hash.h"
+#include "utils/jbox_json.h"
+#include "utils/jbox_linereader.h"
+#include "utils/jbox_signals.h"
+
+
+/** Upper bound on hashing threads, the printing thread included */
+#define HASHSUM_MAX_WORKERS 16
+
+/** Chunks in each BLAKE3 subtree handed to a thread: 1 MiB */
+#define HASHSUM_SUBTREE_CHUNKS 1024
+
+/** Bytes hashed between checks for an interrupt */
+#define HASHSUM_SLICE (16 * 1024 * 1024)
+
+
+typedef enum {
+  HASHSUM_SHA256,
+  HASHSUM_BLAKE3
+} hashsum_algo_t;
+
+/** One file to hash */
+typedef struct {
+  const char *name;
+  const char *expected;     /* Hex digest to check against, or NULL */
+  const uint8_t *map;       /* Mapped contents, or NULL to read a stream */
+  size_t len;
+  int fd;                   /* Stream to read, or -1 */
+  int error;                /* errno if it could not be opened */
+  atomic_size_t pending;    /* Jobs not finished yet */
+  uint32_t (*cvs)[8];       /* Chaining value of each BLAKE3 subtree */
+  size_t subtrees;
+  uint8_t digest[32];
+} hashsum_input_t;
+
+/** A whole mapped file, or one BLAKE3 subtree of it */
+typedef struct {
+  hashsum_input_t *input;
+  size_t subtree;           /* SIZE_MAX for the whole file */
+} hashsum_job_t;
+
+/** Jobs shared by the hashing threads */
+typedef struct {
+  hashsum_algo_t algo;
+  hashsum_job_t *jobs;
+  size_t count;
+  atomic_size_t next;
+  atomic_int interrupted;
+  pthread_mutex_t lock;
+  pthread_cond_t done;      /* An input's last job finished */
+} hashsum_pool_t;
+
+
+typedef struct {
+  struct arg_lit *help;
+  struct arg_str *algorithm;
+  struct arg_lit *check;
+  struct arg_lit *json;
+  struct arg_file *files;
+  struct arg_end *end;
+  void *argtable[6];
+} hashsum_args_t;
+
+
+/**
+ * Build the argument table for the hashsum command.
+ * @param args Pointer to hashsum_args_t structure to populate.
+ */
+static void build_hashsum_argtable(hashsum_args_t *args) {
+  args->help      = arg_lit0("h", "help", "display this help and exit");
+  args->algorithm = arg_str0("a", "algorithm", "NAME",
+                             "sha256 (default) or blake3");
+  args->check     = arg_lit0("c", "check",
+                             "read digests from the FILEs and check them");
+  args->json      = arg_lit0(NULL, "json", "output in JSON format");
+  args->files     = arg_filen(NULL, NULL, "FILE", 0, 100000,
+                              "files to hash (default: standard input)");
+  args->end       = arg_end(20);
+
+  args->argtable[0] = args->help;
+  args->argtable[1] = args->algorithm;
+  args->argtable[2] = args->check;
+  args->argtable[3] = args->json;
+  args->argtable[4] = args->files;
+  args->argtable[5] = args->end;
+}
+
+
+/**
+ * Clean up and free the argument table.
+ * @param args Pointer to hashsum_args_t structure to clean up.
+ */
+static void cleanup_hashsum_argtable(hashsum_args_t *args) {
+  arg_freetable(args->argtable,
+                sizeof(args->argtable) / sizeof(args->argtable[0]));
+}
+
+
+/**
+ * Print usage information for the hashsum command.
+ * @param out Output stream to write usage information to.
+ */
+static void hashsum_print_usage(FILE *out) {
+  hashsum_args_t args;
+  build_hashsum_argtable(&args);
+  fprintf(out, "Usage: hashsum");
+  arg_print_syntax(out, args.argtable, "\n");
+  fprintf(out, "Print or check SHA-256 or BLAKE3 digests.\n\n");
+  fprintf(out, "Options:\n");
+  arg_print_glossary(out, args.argtable, "  %-26s %s\n");
+  cleanup_hashsum_argtable(&args);
+}
+
+
+/**
+ * Passes the hashsum argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void hashsum_describe_args(jshell_argtable_visit_fn visit,
+                                  void *userdata) {
+  hashsum_args_t args;
+  build_hashsum_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_hashsum_argtable(&args);
+}
+
+
+/**
+ * Tells the result cache what the output of hashsum depends on: the named
+ * files; not when reading stdin, nor with --check, which reads files listed
+ * in them.
+ *
+ * @param argc Number of arguments
+ * @param argv Array of argument strings
+ * @return How this run may be cached
+ */
+static jshell_cmd_cache_t hashsum_cache_scope(int argc, char **argv) {
+  hashsum_args_t args;
+  build_hashsum_argtable(&args);
+  int nerrors = arg_parse(argc, argv, args.argtable);
+  jshell_cmd_cache_t scope = CMD_CACHE_NONE;
+  if (nerrors == 0 && args.help->count == 0
+      && args.files->count > 0 && args.check->count == 0) {
+    scope = CMD_CACHE_FILES;
+  }
+  cleanup_hashsum_argtable(&args);
+  return scope;
+}
+
+
+static const char *algo_name(hashsum_algo_t algo) {
+  return algo == HASHSUM_SHA256 ? "sha256" : "blake3";
+}
+
+
+// ---------------------------------------------------------------------------
+// Hashing
+// ---------------------------------------------------------------------------
+
+/**
+ * Hash a whole mapped file a slice at a time.
+ * @return 0 on success, -2 on interrupt.
+ */
+static int hash_whole(hashsum_algo_t algo, hashsum_input_t *in) {
+  jbox_sha256_t sha;
+  jbox_blake3_t b3;
+  if (algo == HASHSUM_SHA256) jbox_sha256_init(&sha);
+  else jbox_blake3_init(&b3);
+
+  for (size_t off = 0; off < in->len; off += HASHSUM_SLICE) {
+    if (jbox_is_interrupted()) return -2;
+    size_t n = in->len - off < HASHSUM_SLICE ? in->len - off : HASHSUM_SLICE;
+    if (algo == HASHSUM_SHA256) jbox_sha256_update(&sha, in->map + off, n);
+    else jbox_blake3_update(&b3, in->map + off, n);
+  }
+
+  if (algo == HASHSUM_SHA256) jbox_sha256_final(&sha, in->digest);
+  else jbox_blake3_final(&b3, in->digest);
+  return 0;
+}
+
+
+static void wake_printer(hashsum_pool_t *pool) {
+  pthread_mutex_lock(&pool->lock);
+  pthread_cond_broadcast(&pool->done);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+
+/**
+ * Take the next job, if any is left, and run it.
+ * @return 1 if a job was run, 0 if none was left or on interrupt.
+ */
+static int run_next_job(hashsum_pool_t *pool) {
+  if (jbox_is_interrupted() && !atomic_exchange(&pool->interrupted, 1)) {
+    wake_printer(pool);
+  }
+  if (atomic_load(&pool->interrupted)) return 0;
+  size_t i = atomic_fetch_add(&pool->next, 1);
+  if (i >= pool->count) return 0;
+
+  hashsum_job_t *job = &pool->jobs[i];
+  hashsum_input_t *in = job->input;
+  if (job->subtree == SIZE_MAX) {
+    if (hash_whole(pool->algo, in) != 0) {
+      atomic_store(&pool->interrupted, 1);
+    }
+  } else {
+    size_t first = job->subtree * HASHSUM_SUBTREE_CHUNKS;
+    jbox_blake3_subtree(in->map + first * JBOX_BLAKE3_CHUNK,
+                        HASHSUM_SUBTREE_CHUNKS, first,
+                        in->cvs[job->subtree]);
+  }
+
+  /* Wake the printing thread when the input is complete, or when it
+   * never will be */
+  if (atomic_fetch_sub(&in->pending, 1) == 1 ||
+      atomic_load(&pool->interrupted)) {
+    wake_printer(pool);
+  }
+  return 1;
+}
+
+
+static void *hashsum_worker(void *arg) {
+  hashsum_pool_t *pool = arg;
+  while (run_next_job(pool)) {
+  }
+  return NULL;
+}
+
+
+/**
+ * Wait until all jobs of a mapped input are done, running jobs meanwhile.
+ * @return 0 when done, -2 on interrupt.
+ */
+static int wait_input(hashsum_pool_t *pool, hashsum_input_t *in) {
+  while (atomic_load(&in->pending) > 0) {
+    if (run_next_job(pool)) continue;
+    pthread_mutex_lock(&pool->lock);
+    while (atomic_load(&in->pending) > 0 &&
+           !atomic_load(&pool->interrupted) && !jbox_is_interrupted()) {
+      pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if (atomic_load(&pool->interrupted) || jbox_is_interrupted()) return -2;
+  }
+  /* A job cut short by an interrupt still counts as finished */
+  return atomic_load(&pool->interrupted) ? -2 : 0;
+}
+
+
+/**
+ * Finish a BLAKE3 input cut into subtrees: join their chaining values
+ * and hash the rest of the file.
+ */
+static void finish_subtrees(hashsum_input_t *in) {
+  jbox_blake3_t b3;
+  jbox_blake3_init(&b3);
+  for (size_t i = 0; i < in->subtrees; i++) {
+    jbox_blake3_add_subtree(&b3, in->cvs[i], HASHSUM_SUBTREE_CHUNKS);
+  }
+  size_t done = in->subtrees * HASHSUM_SUBTREE_CHUNKS * JBOX_BLAKE3_CHUNK;
+  jbox_blake3_update(&b3, in->map + done, in->len - done);
+  jbox_blake3_final(&b3, in->digest);
+}
+
+
+/**
+ * Hash a stream on the calling thread.
+ * @return 0 on success, -1 on error (printed), -2 on interrupt.
+ */
+static int hash_stream(hashsum_algo_t algo, hashsum_input_t *in) {
+  jbox_aio_t *aio = jbox_aio_open(in->fd, 0);
+  if (!aio) {
+    fprintf(stderr, "hashsum: out of memory\n");
+    return -1;
+  }
+
+  jbox_sha256_t sha;
+  jbox_blake3_t b3;
+  if (algo == HASHSUM_SHA256) jbox_sha256_init(&sha);
+  else jbox_blake3_init(&b3);
+
+  int rc = 0;
+  for (;;) {
+    if (jbox_is_interrupted()) {
+      rc = -2;
+      break;
+    }
+    const char *data;
+    ssize_t n = jbox_aio_read(aio, &data);
+    if (n < 0) {
+      fprintf(stderr, "hashsum: %s: %s\n", in->name, strerror(errno));
+      rc = -1;
+      break;
+    }
+    if (n == 0) break;
+    if (algo == HASHSUM_SHA256) jbox_sha256_update(&sha, data, (size_t)n);
+    else jbox_blake3_update(&b3, data, (size_t)n);
+  }
+  jbox_aio_close(aio);
+
+  if (rc == 0) {
+    if (algo == HASHSUM_SHA256) jbox_sha256_final(&sha, in->digest);
+    else jbox_blake3_final(&b3, in->digest);
+  }
+  return rc;
+}
+
+
+// ---------------------------------------------------------------------------
+// Inputs
+// ---------------------------------------------------------------------------
+
+/**
+ * Open an input: map it if it is a non-empty regular file, otherwise
+ * keep its descriptor to read as a stream. Failures are kept in
+ * in->error to be reported in order.
+ */
+static void open_input(hashsum_input_t *in) {
+  in->fd = -1;
+  int is_stdin = strcmp(in->name, "-") == 0;
+  int fd = is_stdin ? STDIN_FILENO : open(in->name, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    in->error = errno;
+    return;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) st.st_mode = 0;
+  if (S_ISDIR(st.st_mode)) {
+    in->error = EISDIR;
+    if (!is_stdin) close(fd);
+    return;
+  }
+  if (S_ISREG(st.st_mode) && st.st_size > 0 &&
+      (!is_stdin || lseek(fd, 0, SEEK_CUR) == 0)) {
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+      in->map = map;
+      in->len = (size_t)st.st_size;
+      if (!is_stdin) close(fd);
+      return;
+    }
+  }
+  in->fd = fd;
+}
+
+
+static void close_input(hashsum_input_t *in) {
+  if (in->map) munmap((void *)in->map, in->len);
+  if (in->fd > STDIN_FILENO) close(in->fd);
+  free(in->cvs);
+  in->map = NULL;
+  in->fd = -1;
+  in->cvs = NULL;
+}
+
+
+/**
+ * Queue the jobs of a mapped input.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int add_jobs(hashsum_algo_t algo, hashsum_input_t *in,
+                    hashsum_job_t **jobs, size_t *count, size_t *cap) {
+  size_t subtrees = 0;
+  if (algo == HASHSUM_BLAKE3) {
+    /* Whole subtrees that leave at least one byte after them, since the
+     * last chunk must be hashed as the end of the input */
+    size_t chunks = (in->len + JBOX_BLAKE3_CHUNK - 1) / JBOX_BLAKE3_CHUNK;
+    subtrees = (chunks - 1) / HASHSUM_SUBTREE_CHUNKS;
+  }
+  size_t need = subtrees > 0 ? subtrees : 1;
+
+  if (subtrees > 0) {
+    in->cvs = malloc(subtrees * sizeof(*in->cvs));
+    if (!in->cvs) return -1;
+    in->subtrees = subtrees;
+  }
+  while (*count + need > *cap) {
+    size_t new_cap = *cap ? *cap * 2 : 64;
+    hashsum_job_t *grown = realloc(*jobs, new_cap * sizeof(**jobs));
+    if (!grown) return -1;
+    *jobs = grown;
+    *cap = new_cap;
+  }
+
+  atomic_store(&in->pending, need);
+  if (subtrees == 0) {
+    (*jobs)[(*count)++] = (hashsum_job_t){ in, SIZE_MAX };
+  } else {
+    for (size_t i = 0; i < subtrees; i++) {
+      (*jobs)[(*count)++] = (hashsum_job_t){ in, i };
+    }
+  }
+  return 0;
+}
+
+
+/** Lines of a checksum file that could not be parsed */
+typedef struct {
+  size_t bad_lines;
+} hashsum_check_stats_t;
+
+
+/**
+ * Read "HEX  NAME" lines (or "HEX *NAME") from a checksum file into
+ * inputs to check.
+ * @return 0 on success, -1 on error (printed), -2 on interrupt.
+ */
+static int read_check_file(const char *name, hashsum_input_t **inputs,
+                           size_t *count, size_t *cap,
+                           hashsum_check_stats_t *stats) {
+  int is_stdin = strcmp(name, "-") == 0;
+  int fd = is_stdin ? STDIN_FILENO : open(name, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "hashsum: %s: %s\n", name, strerror(errno));
+    return -1;
+  }
+
+  jbox_linereader_t reader;
+  if (jbox_linereader_init(&reader, fd) != 0) {
+    fprintf(stderr, "hashsum: out of memory\n");
+    if (!is_stdin) close(fd);
+    return -1;
+  }
+
+  int rc = 0;
+  char *line;
+  size_t len;
+  for (;;) {
+    int got = jbox_linereader_next(&reader, &line, &len);
+    if (got != 1) {
+      if (got == -1) {
+        fprintf(stderr, "hashsum: %s: %s\n", name, strerror(errno));
+      }
+      rc = got;
+      break;
+    }
+    if (len > 0 && line[len - 1] == '\r') line[--len] = '\0';
+    if (len == 0 || line[0] == '#') continue;
+
+    size_t hex = strspn(line, "0123456789abcdefABCDEF");
+    if (hex != 2 * JBOX_SHA256_LEN || len < hex + 3 || line[hex] != ' ' ||
+        (line[hex + 1] != ' ' && line[hex + 1] != '*')) {
+      stats->bad_lines++;
+      continue;
+    }
+
+    if (*count >= *cap) {
+      size_t new_cap = *cap ? *cap * 2 : 64;
+      hashsum_input_t *grown = realloc(*inputs, new_cap * sizeof(**inputs));
+      if (!grown) {
+        fprintf(stderr, "hashsum: out of memory\n");
+        rc = -1;
+        break;
+      }
+      *inputs = grown;
+      *cap = new_cap;
+    }
+    char *copy = strdup(line);
+    if (!copy) {
+      fprintf(stderr, "hashsum: out of memory\n");
+      rc = -1;
+      break;
+    }
+    for (size_t i = 0; i < hex; i++) {
+      if (copy[i] >= 'A' && copy[i] <= 'F') copy[i] += 'a' - 'A';
+    }
+    copy[hex] = '\0';
+    hashsum_input_t *in = &(*inputs)[(*count)++];
+    memset(in, 0, sizeof(*in));
+    in->expected = copy;
+    in->name = copy + hex + 2;
+  }
+
+  jbox_linereader_free(&reader);
+  if (!is_stdin) close(fd);
+  return rc;
+}
+
+
+// ---------------------------------------------------------------------------
+// Output
+// ---------------------------------------------------------------------------
+
+/**
+ * Print the result for one input.
+ * @return 1 if it was checked and did not match, 0 otherwise.
+ */
+static int print_result(const hashsum_input_t *in, hashsum_algo_t algo,
+                        int json, size_t *printed) {
+  char hex[2 * JBOX_SHA256_LEN + 1];
+  jbox_hash_hex(in->digest, JBOX_SHA256_LEN, hex);
+  int mismatch = in->expected && strcmp(in->expected, hex) != 0;
+
+  if (json) {
+    fputs(*printed == 0 ? "  {\"file\": " : ",\n  {\"file\": ",
+          jbox_stdout());
+    jbox_json_write_string(jbox_stdout(), in->name);
+    jbox_printf(", \"algorithm\": \"%s\", \"hash\": \"%s\"", algo_name(algo),
+                hex);
+    if (in->expected) {
+      jbox_printf(", \"ok\": %s", mismatch ? "false" : "true");
+    }
+    jbox_printf("}");
+  } else if (in->expected) {
+    jbox_printf("%s: %s\n", in->name, mismatch ? "FAILED" : "OK");
+  } else {
+    jbox_printf("%s  %s\n", hex, in->name);
+  }
+  (*printed)++;
+  return mismatch;
+}
+
+
+/**
+ * Main entry point for the hashsum command.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return Exit status (0 on success, 1 on error or a failed check, 130
+ *         on interrupt).
+ */
+static int hashsum_run(int argc, char **argv) {
+  hashsum_args_t args;
+  build_hashsum_argtable(&args);
+
+  jbox_setup_sigint_handler();
+
+  int nerrors = arg_parse(argc, argv, args.argtable);
+
+  if (args.help->count > 0) {
+    hashsum_print_usage(jbox_stdout());
+    cleanup_hashsum_argtable(&args);
+    return 0;
+  }
+
+  if (nerrors > 0) {
+    arg_print_errors(stderr, args.end, "hashsum");
+    fprintf(stderr, "Try 'hashsum --help' for more information.\n");
+    cleanup_hashsum_argtable(&args);
+    return 1;
+  }
+
+  hashsum_algo_t algo = HASHSUM_SHA256;
+  if (args.algorithm->count > 0) {
+    const char *name = args.algorithm->sval[0];
+    if (strcmp(name, "sha256") == 0) {
+      algo = HASHSUM_SHA256;
+    } else if (strcmp(name, "blake3") == 0) {
+      algo = HASHSUM_BLAKE3;
+    } else {
+      fprintf(stderr, "hashsum: unknown algorithm '%s'\n", name);
+      fprintf(stderr, "Try 'hashsum --help' for more information.\n");
+      cleanup_hashsum_argtable(&args);
+      return 1;
+    }
+  }
+  int json = args.json->count > 0;
+  int check = args.check->count > 0;
+
+  /* Gather the inputs: the FILEs, or the files listed in them */
+  hashsum_input_t *inputs = NULL;
+  size_t input_count = 0, input_cap = 0;
+  hashsum_check_stats_t stats = {0};
+  int file_errors = 0;
+  int rc = 0;
+  int file_count = args.files->count > 0 ? args.files->count : 1;
+  if (check) {
+    for (int i = 0; i < file_count && rc != -2; i++) {
+      const char *name = args.files->count > 0 ? args.files->filename[i] : "-";
+      int got = read_check_file(name, &inputs, &input_count, &input_cap,
+                                &stats);
+      if (got == -1) file_errors = 1;
+      else if (got != 0) rc = got;
+    }
+  } else {
+    inputs = calloc((size_t)file_count, sizeof(hashsum_input_t));
+    if (inputs) {
+      input_count = (size_t)file_count;
+      for (int i = 0; i < file_count; i++) {
+        inputs[i].name = args.files->count > 0 ? args.files->filename[i] : "-";
+      }
+    } else {
+      fprintf(stderr, "hashsum: out of memory\n");
+      rc = -1;
+    }
+  }
+
+  /* Map every input and queue its jobs */
+  hashsum_job_t *jobs = NULL;
+  size_t job_count = 0, job_cap = 0;
+  for (size_t i = 0; i < input_count && rc == 0; i++) {
+    open_input(&inputs[i]);
+    if (inputs[i].map &&
+        add_jobs(algo, &inputs[i], &jobs, &job_count, &job_cap) != 0) {
+      fprintf(stderr, "hashsum: out of memory\n");
+      rc = -1;
+    }
+  }
+
+  hashsum_pool_t pool = { .algo = algo, .jobs = jobs, .count = job_count };
+  atomic_init(&pool.next, 0);
+  atomic_init(&pool.interrupted, 0);
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.done, NULL);
+
+  /* The printing thread is a worker too, so start one fewer */
+  pthread_t threads[HASHSUM_MAX_WORKERS];
+  int started[HASHSUM_MAX_WORKERS] = {0};
+  int worker_count = 0;
+  if (rc == 0 && job_count > 0) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    worker_count = cores > 0 ? (int)cores : 1;
+    if (worker_count > HASHSUM_MAX_WORKERS) worker_count = HASHSUM_MAX_WORKERS;
+    if ((size_t)worker_count > job_count) worker_count = (int)job_count;
+    for (int i = 1; i < worker_count; i++) {
+      started[i] = pthread_create(&threads[i], NULL, hashsum_worker,
+                                  &pool) == 0;
+    }
+  }
+
+  /* Print in order as inputs complete */
+  size_t printed = 0, mismatches = 0, unreadable = 0;
+  if (json && rc == 0) jbox_printf("[\n");
+  for (size_t i = 0; i < input_count && rc == 0; i++) {
+    hashsum_input_t *in = &inputs[i];
+    if (in->error) {
+      fprintf(stderr, "hashsum: %s: %s\n", in->name, strerror(in->error));
+      file_errors = 1;
+      unreadable++;
+      continue;
+    }
+    if (in->map) {
+      if (wait_input(&pool, in) != 0) {
+        rc = -2;
+        break;
+      }
+      if (in->subtrees > 0) finish_subtrees(in);
+    } else {
+      int got = hash_stream(algo, in);
+      if (got == -1) {
+        file_errors = 1;
+        unreadable++;
+        close_input(in);
+        continue;
+      }
+      if (got != 0) {
+        rc = got;
+        break;
+      }
+    }
+    mismatches += (size_t)print_result(in, algo, json, &printed);
+    close_input(in);
+  }
+  if (json && rc == 0) jbox_printf(printed > 0 ? "\n]\n" : "]\n");
+  fflush(jbox_stdout());
+
+  /* Stop the workers; on interrupt they give up their remaining jobs */
+  if (rc != 0) atomic_store(&pool.interrupted, 1);
+  for (int i = 1; i < worker_count; i++) {
+    if (started[i]) pthread_join(threads[i], NULL);
+  }
+  pthread_mutex_destroy(&pool.lock);
+  pthread_cond_destroy(&pool.done);
+
+  if (check && rc == 0) {
+    if (stats.bad_lines > 0) {
+      fprintf(stderr, "hashsum: WARNING: %zu line%s improperly formatted\n",
+              stats.bad_lines, stats.bad_lines == 1 ? " is" : "s are");
+    }
+    if (unreadable > 0) {
+      fprintf(stderr, "hashsum: WARNING: %zu listed file%s could not be "
+              "read\n", unreadable, unreadable == 1 ? "" : "s");
+    }
+    if (mismatches > 0) {
+      fprintf(stderr, "hashsum: WARNING: %zu computed checksum%s did NOT "
+              "match\n", mismatches, mismatches == 1 ? "" : "s");
+    }
+  }
+
+  for (size_t i = 0; i < input_count; i++) {
+    close_input(&inputs[i]);
+    if (check) free((void *)inputs[i].expected);
+  }
+  free(inputs);
+  free(jobs);
+  cleanup_hashsum_argtable(&args);
+
+  if (rc == -2) return 130;   /* 128 + SIGINT(2) */
+  return rc == 0 && !file_errors && mismatches == 0 ? 0 : 1;
+}
+
+
+/**
+ * Command specification for hashsum command.
+ */
+const jshell_cmd_spec_t cmd_hashsum_spec = {
+  .name = "hashsum",
+  .summary = "compute and check SHA-256 and BLAKE3 digests",
+  .long_help = "Print the SHA-256 (or with -a blake3, BLAKE3) digest of "
+               "each FILE (or standard input) as `HEX  NAME`, like "
+               "sha256sum and b3sum; -c checks the digests listed in the "
+               "FILEs instead. Files are hashed in parallel, and large "
+               "files are split across cores for BLAKE3.",
+  .type = CMD_EXTERNAL,
+  .run = hashsum_run,
+  .print_usage = hashsum_print_usage,
+  .describe_args = hashsum_describe_args,
+  .cache_scope = hashsum_cache_scope
+};
+
+
+/**
+ * Registers the hashsum command with the shell command registry.
+ */
+void jshell_register_hashsum_command(void) {
+  jshell_register_command(&cmd_hashsum_spec);
+}
@@ -0,0 +1,10 @@
+#ifndef CMD_HASHSUM_H
+#define CMD_HASHSUM_H
+
+#include "jshell/jshell_cmd_registry.h"
+
+extern const jshell_cmd_spec_t cmd_hashsum_spec;
+
+void jshell_register_hashsum_command(void);
+
+#endif
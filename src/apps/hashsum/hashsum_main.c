@@ -0,0 +1,17 @@
+/**
+ * @file hashsum_main.c
+ * @brief Main entry point for standalone hashsum command.
+ */
+
+#include "cmd_hashsum.h"
+
+
+/**
+ * Main entry point for standalone hashsum binary.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return Exit status from hashsum_run.
+ */
+int main(int argc, char **argv) {
+  return cmd_hashsum_spec.run(argc, argv);
+}
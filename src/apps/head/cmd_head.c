@@ -7,12 +7,19 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_ctx.h"
 #include "utils/jbox_signals.h"
+#include "utils/jbox_json.h"
 
 #define DEFAULT_LINES 10
+#define HEAD_BLOCK_SIZE (64 * 1024)
 
 
 /**
@@ -21,10 +28,11 @@
 typedef struct {
   struct arg_lit *help;
   struct arg_int *num_lines;
+  struct arg_int *num_bytes;
   struct arg_lit *json;
   struct arg_file *file;
   struct arg_end *end;
-  void *argtable[5];
+  void *argtable[6];
 } head_args_t;
 
 
@@ -37,15 +45,18 @@ static void build_head_argtable(head_args_t *args) {
   args->help      = arg_lit0("h", "help", "display this help and exit");
   args->num_lines = arg_int0("n", NULL, "N",
                              "output the first N lines (default 10)");
+  args->num_bytes = arg_int0("c", "bytes", "BYTES",
+                             "output the first BYTES bytes instead of lines");
   args->json      = arg_lit0(NULL, "json", "output in JSON format");
   args->file      = arg_file0(NULL, NULL, "FILE", "file to read (stdin if omitted)");
   args->end       = arg_end(20);
 
   args->argtable[0] = args->help;
   args->argtable[1] = args->num_lines;
-  args->argtable[2] = args->json;
-  args->argtable[3] = args->file;
-  args->argtable[4] = args->end;
+  args->argtable[2] = args->num_bytes;
+  args->argtable[3] = args->json;
+  args->argtable[4] = args->file;
+  args->argtable[5] = args->end;
 }
 
 
@@ -78,63 +89,251 @@ static void head_print_usage(FILE *out) {
 
 
 /**
- * Escapes special characters in a string for JSON output.
+ * Passes the head argtable to visit, for tool schemas derived from it.
  *
- * @param str      The input string to escape.
- * @param out      Buffer to write the escaped string to.
- * @param out_size Size of the output buffer.
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
  */
-static void escape_json_string(const char *str, char *out, size_t out_size) {
-  size_t j = 0;
-  for (size_t i = 0; str[i] && j < out_size - 1; i++) {
-    char c = str[i];
-    if (c == '"' || c == '\\') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = c;
-    } else if (c == '\n') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = 'n';
-    } else if (c == '\r') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = 'r';
-    } else if (c == '\t') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = 't';
+static void head_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  head_args_t args;
+  build_head_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_head_argtable(&args);
+}
+
+
+/**
+ * Tells the result cache what the output of head depends on: the named
+ * file; not when reading stdin.
+ *
+ * @param argc Number of arguments
+ * @param argv Array of argument strings
+ * @return How this run may be cached
+ */
+static jshell_cmd_cache_t head_cache_scope(int argc, char **argv) {
+  head_args_t args;
+  build_head_argtable(&args);
+  int nerrors = arg_parse(argc, argv, args.argtable);
+  jshell_cmd_cache_t scope = CMD_CACHE_NONE;
+  if (nerrors == 0 && args.help->count == 0
+      && args.file->count > 0) {
+    scope = CMD_CACHE_FILES;
+  }
+  cleanup_head_argtable(&args);
+  return scope;
+}
+
+
+/** Block buffer that input is read into, allocated per invocation. */
+static thread_local char *head_buffer;
+
+
+/**
+ * Output state: text passes through, JSON gets one array item per line.
+ */
+typedef struct {
+  int show_json;
+  int line_open;  /* A line has been started but not yet ended */
+  int emitted;    /* Number of lines started so far */
+} head_out_t;
+
+
+/**
+ * Writes a span of complete or partial lines.
+ *
+ * @param out  Output state.
+ * @param data Bytes to write, '\n' ending each line.
+ * @param len  Number of bytes in data.
+ */
+static void head_out_write(head_out_t *out, const char *data, size_t len) {
+  if (len == 0) {
+    return;
+  }
+
+  if (!out->show_json) {
+    fwrite(data, 1, len, jbox_stdout());
+    out->line_open = data[len - 1] != '\n';
+    return;
+  }
+
+  while (len > 0) {
+    if (!out->line_open) {
+      fputs(out->emitted++ > 0 ? ", \"" : "\"", jbox_stdout());
+      out->line_open = 1;
+    }
+    const char *nl = memchr(data, '\n', len);
+    size_t n = nl ? (size_t)(nl - data) : len;
+    jbox_json_write_escaped(jbox_stdout(), data, n);
+    if (!nl) {
+      break;
+    }
+    fputc('"', jbox_stdout());
+    out->line_open = 0;
+    data += n + 1;
+    len -= n + 1;
+  }
+}
+
+
+/**
+ * Ends the last line if the input did not.
+ *
+ * @param out Output state.
+ */
+static void head_out_finish(head_out_t *out) {
+  if (out->line_open) {
+    fputc(out->show_json ? '"' : '\n', jbox_stdout());
+    out->line_open = 0;
+  }
+}
+
+
+/**
+ * Reads into head_buffer, retrying on EINTR unless interrupted.
+ *
+ * @return Bytes read, 0 at EOF, -1 on error, -2 on interruption.
+ */
+static ssize_t head_read(int fd, size_t len) {
+  for (;;) {
+    if (jbox_is_interrupted()) {
+      return -2;
+    }
+    ssize_t n = read(fd, head_buffer, len);
+    if (n >= 0 || errno != EINTR) {
+      return n;
+    }
+  }
+}
+
+
+/**
+ * Gives back input read past what was output, when fd can seek, so a
+ * shared stdin is left positioned right after the head.
+ */
+static void head_unread(int fd, size_t extra) {
+  if (extra > 0) {
+    lseek(fd, -(off_t)extra, SEEK_CUR);
+  }
+}
+
+
+/**
+ * Outputs the first N lines, scanning whole blocks with memchr.
+ *
+ * @return 0 on success, -1 on read error, -2 on interruption.
+ */
+static int head_lines(int fd, int num_lines, head_out_t *out) {
+  int remaining = num_lines;
+
+  while (remaining > 0) {
+    ssize_t n = head_read(fd, HEAD_BLOCK_SIZE);
+    if (n <= 0) {
+      return (int)n;
+    }
+
+    const char *p = head_buffer;
+    const char *end = head_buffer + n;
+    while (remaining > 0 && p < end) {
+      const char *nl = memchr(p, '\n', (size_t)(end - p));
+      if (!nl) {
+        break;
+      }
+      p = nl + 1;
+      remaining--;
+    }
+
+    if (remaining == 0) {
+      head_out_write(out, head_buffer, (size_t)(p - head_buffer));
+      head_unread(fd, (size_t)(end - p));
+      return 0;
+    }
+    head_out_write(out, head_buffer, (size_t)n);
+  }
+  return 0;
+}
+
+
+/**
+ * Outputs the first BYTES bytes.
+ *
+ * Text output of a regular file goes through sendfile(), so the data
+ * never enters user space; other input is copied in blocks.
+ *
+ * @return 0 on success, -1 on read error, -2 on interruption.
+ */
+static int head_bytes(int fd, long long num_bytes, head_out_t *out) {
+  long long remaining = num_bytes;
+  struct stat st;
+
+  if (!out->show_json && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    fflush(jbox_stdout());
+    while (remaining > 0) {
+      if (jbox_is_interrupted()) {
+        return -2;
+      }
+      ssize_t n = sendfile(jbox_stdout_fd(), fd, NULL, (size_t)remaining);
+      if (n == 0) {
+        return 0;
+      }
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (remaining == num_bytes &&
+            (errno == EINVAL || errno == ENOSYS)) {
+          break;  /* This output cannot take sendfile(); copy instead */
+        }
+        return -1;
+      }
+      remaining -= n;
+    }
+  }
+
+  while (remaining > 0) {
+    size_t want = remaining > HEAD_BLOCK_SIZE
+                    ? HEAD_BLOCK_SIZE : (size_t)remaining;
+    ssize_t n = head_read(fd, want);
+    if (n <= 0) {
+      return (int)n;
+    }
+    if (out->show_json) {
+      jbox_json_write_escaped(jbox_stdout(), head_buffer, (size_t)n);
     } else {
-      out[j++] = c;
+      fwrite(head_buffer, 1, (size_t)n, jbox_stdout());
     }
+    remaining -= n;
   }
-  out[j] = '\0';
+  return 0;
 }
 
 
 /**
- * Reads and outputs the first N lines of a file.
+ * Reads and outputs the first N lines, or first BYTES bytes, of a file.
  *
  * @param path      Path to the file, or NULL/"-" for stdin.
  * @param num_lines Number of lines to output.
+ * @param num_bytes Number of bytes to output instead, or -1 for lines.
  * @param show_json If non-zero, output in JSON format.
  * @return 0 on success, non-zero on error or interruption.
  */
-static int head_file(const char *path, int num_lines, int show_json) {
-  FILE *fp;
+static int head_file(const char *path, int num_lines, long long num_bytes,
+                     int show_json) {
+  int fd;
   int is_stdin = (path == NULL || strcmp(path, "-") == 0);
 
   if (is_stdin) {
-    fp = stdin;
+    fd = jbox_stdin_fd();
     path = "<stdin>";
   } else {
-    fp = fopen(path, "r");
-    if (!fp) {
+    fd = openat(jbox_cwd_fd(), path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
       if (show_json) {
-        char escaped_path[512];
-        escape_json_string(path, escaped_path, sizeof(escaped_path));
-        printf("{\"path\": \"%s\", \"error\": \"%s\"}\n",
-               escaped_path, strerror(errno));
+        const char *error = strerror(errno);
+        jbox_printf("{\"path\": ");
+        jbox_json_write_string(jbox_stdout(), path);
+        jbox_printf(", \"error\": ");
+        jbox_json_write_string(jbox_stdout(), error);
+        jbox_printf("}\n");
       } else {
         fprintf(stderr, "head: %s: %s\n", path, strerror(errno));
       }
@@ -142,71 +341,46 @@ static int head_file(const char *path, int num_lines, int show_json) {
     }
   }
 
+  head_out_t out = { .show_json = show_json };
+  int rc;
+
   if (show_json) {
-    char escaped_path[512];
-    escape_json_string(path, escaped_path, sizeof(escaped_path));
-    printf("{\"path\": \"%s\", \"lines\": [", escaped_path);
+    jbox_printf("{\"path\": ");
+    jbox_json_write_string(jbox_stdout(), path);
   }
 
-  char *line = NULL;
-  size_t len = 0;
-  ssize_t nread;
-  int line_count = 0;
-  int first_line = 1;
-
-  while (line_count < num_lines && (nread = getline(&line, &len, fp)) != -1) {
-    /* Check for interrupt */
-    if (jbox_is_interrupted()) {
-      free(line);
-      if (!is_stdin) {
-        fclose(fp);
-      }
-      if (show_json) {
-        printf("]}\n");
-      }
-      return 130;  /* 128 + SIGINT(2) */
+  if (num_bytes >= 0) {
+    if (show_json) {
+      jbox_printf(", \"data\": \"");
     }
-
-    // Remove trailing newline for JSON output, keep for plain output
-    size_t line_len = (size_t)nread;
-    if (line_len > 0 && line[line_len - 1] == '\n') {
-      line[line_len - 1] = '\0';
-      line_len--;
+    rc = head_bytes(fd, num_bytes, &out);
+    if (show_json) {
+      jbox_printf("\"}\n");
     }
-
+  } else {
     if (show_json) {
-      if (!first_line) {
-        printf(", ");
-      }
-      first_line = 0;
-
-      // Escape and print the line
-      size_t escaped_size = line_len * 2 + 1;
-      if (escaped_size < 256) escaped_size = 256;
-      char *escaped_line = malloc(escaped_size);
-      if (escaped_line) {
-        escape_json_string(line, escaped_line, escaped_size);
-        printf("\"%s\"", escaped_line);
-        free(escaped_line);
-      } else {
-        printf("\"\"");
-      }
-    } else {
-      printf("%s\n", line);
+      jbox_printf(", \"lines\": [");
+    }
+    rc = head_lines(fd, num_lines, &out);
+    head_out_finish(&out);
+    if (show_json) {
+      jbox_printf("]}\n");
     }
-
-    line_count++;
   }
+  int saved_errno = errno;
 
-  free(line);
   if (!is_stdin) {
-    fclose(fp);
+    close(fd);
   }
 
-  if (show_json) {
-    printf("]}\n");
+  if (rc == -2) {
+    return 130;  /* 128 + SIGINT(2) */
+  }
+  if (rc == -1) {
+    fflush(jbox_stdout());
+    fprintf(stderr, "head: %s: %s\n", path, strerror(saved_errno));
+    return 1;
   }
-
   return 0;
 }
 
@@ -230,7 +404,7 @@ static int head_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    head_print_usage(stdout);
+    head_print_usage(jbox_stdout());
     cleanup_head_argtable(&args);
     return 0;
   }
@@ -252,11 +426,35 @@ static int head_run(int argc, char **argv) {
     }
   }
 
+  long long num_bytes = -1;
+  if (args.num_bytes->count > 0) {
+    if (args.num_lines->count > 0) {
+      fprintf(stderr, "head: -n and -c cannot be combined\n");
+      cleanup_head_argtable(&args);
+      return 1;
+    }
+    num_bytes = args.num_bytes->ival[0];
+    if (num_bytes < 0) {
+      fprintf(stderr, "head: invalid number of bytes: %lld\n", num_bytes);
+      cleanup_head_argtable(&args);
+      return 1;
+    }
+  }
+
   int show_json = args.json->count > 0;
   const char *path = (args.file->count > 0) ? args.file->filename[0] : NULL;
 
-  int result = head_file(path, num_lines, show_json);
+  head_buffer = jbox_alloc(HEAD_BLOCK_SIZE);
+  if (!head_buffer) {
+    fprintf(stderr, "head: %s\n", strerror(ENOMEM));
+    cleanup_head_argtable(&args);
+    return 1;
+  }
+
+  int result = head_file(path, num_lines, num_bytes, show_json);
 
+  jbox_release(head_buffer);
+  head_buffer = NULL;
   cleanup_head_argtable(&args);
   return result;
 }
@@ -269,10 +467,14 @@ const jshell_cmd_spec_t cmd_head_spec = {
   .name = "head",
   .summary = "output the first part of files",
   .long_help = "Print the first N lines of FILE to standard output. "
-               "With --json, outputs a JSON object with path and lines array.",
+               "With -c, print the first BYTES bytes instead. "
+               "With --json, outputs a JSON object with path and lines array "
+               "(or data string with -c).",
   .type = CMD_EXTERNAL,
   .run = head_run,
-  .print_usage = head_print_usage
+  .print_usage = head_print_usage,
+  .describe_args = head_describe_args,
+  .cache_scope = head_cache_scope
 };
 
 
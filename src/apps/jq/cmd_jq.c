@@ -0,0 +1,2276 @@
+/**
+ * @file cmd_jq.c
+ * @brief Jq command implementation for jshell.
+ *
+ * Runs a subset of the jq language (paths, pipes, select, map, object and
+ * array construction, comparisons and a few builtins) over the JSON that
+ * other jbox commands print. Input is a stream of values, NDJSON or one
+ * document, read through one reusable buffer: each value is cut out of
+ * the stream by a structural scan before it is parsed, so values are
+ * evaluated as they arrive and memory is bounded by the largest value,
+ * not the input.
+ *
+ * A query that starts with .[] is applied to the elements of a top-level
+ * array one at a time, so `ls --json | jq '.[] | ...'` never holds the
+ * whole array either. Before evaluating, the query is analysed for the
+ * members of its input it reads; members nothing reads are skipped by the
+ * scan without being decoded or stored.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <float.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "argtable3.h"
+#include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_ctx.h"
+#include "utils/jbox_json.h"
+#include "utils/jbox_linereader.h"
+#include "utils/jbox_signals.h"
+
+
+/** Size of each arena block; larger requests get a block of their own */
+#define JQ_ARENA_BLOCK (64 * 1024)
+
+/** Most distinct members a query may read before all are kept */
+#define JQ_MAX_KEEP 32
+
+
+// ---------------------------------------------------------------------------
+// Values
+// ---------------------------------------------------------------------------
+
+/** Value types, in jq's sort order */
+typedef enum {
+  JQ_NULL,
+  JQ_FALSE,
+  JQ_TRUE,
+  JQ_NUMBER,
+  JQ_STRING,
+  JQ_ARRAY,
+  JQ_OBJECT,
+} jq_type_t;
+
+typedef struct jq_value jq_value_t;
+
+/** One member of an object */
+typedef struct {
+  const char *key;
+  size_t key_len;
+  jq_value_t *value;
+} jq_member_t;
+
+/** A value; all of its parts live in one arena */
+struct jq_value {
+  jq_type_t type;
+  size_t len;               /* String bytes, array items or members */
+  double num;
+  const char *text;         /* Number as written in the input, or NULL */
+  const char *str;
+  jq_value_t **items;
+  jq_member_t *members;
+};
+
+static jq_value_t jq_null = { .type = JQ_NULL };
+static jq_value_t jq_false = { .type = JQ_FALSE };
+static jq_value_t jq_true = { .type = JQ_TRUE };
+
+static const char *const TYPE_NAMES[] = {
+  "null", "boolean", "boolean", "number", "string", "array", "object",
+};
+
+
+/** Block of arena memory */
+typedef struct jq_block {
+  struct jq_block *next;
+  size_t used;
+  size_t cap;
+  max_align_t data[];
+} jq_block_t;
+
+/** Bump allocator, freed all at once */
+typedef struct {
+  jq_block_t *blocks;       /* Newest first */
+} jq_arena_t;
+
+
+/**
+ * Allocate from an arena.
+ * @return Memory aligned for any type, or NULL if out of memory.
+ */
+static void *arena_alloc(jq_arena_t *arena, size_t size) {
+  size = (size + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1);
+  jq_block_t *b = arena->blocks;
+  if (!b || b->cap - b->used < size) {
+    size_t cap = size > JQ_ARENA_BLOCK ? size : JQ_ARENA_BLOCK;
+    b = malloc(sizeof(jq_block_t) + cap);
+    if (!b) return NULL;
+    b->used = 0;
+    b->cap = cap;
+    b->next = arena->blocks;
+    arena->blocks = b;
+  }
+  void *p = (char *)b->data + b->used;
+  b->used += size;
+  return p;
+}
+
+
+/**
+ * Free everything allocated, keeping the oldest block for reuse.
+ */
+static void arena_reset(jq_arena_t *arena) {
+  jq_block_t *b = arena->blocks;
+  while (b && b->next) {
+    jq_block_t *next = b->next;
+    free(b);
+    b = next;
+  }
+  if (b) b->used = 0;
+  arena->blocks = b;
+}
+
+
+static void arena_free(jq_arena_t *arena) {
+  arena_reset(arena);
+  free(arena->blocks);
+  arena->blocks = NULL;
+}
+
+
+// ---------------------------------------------------------------------------
+// Queries
+// ---------------------------------------------------------------------------
+
+typedef enum {
+  JQ_N_IDENTITY,
+  JQ_N_FIELD,               /* .name */
+  JQ_N_INDEX,               /* .[n] */
+  JQ_N_ITERATE,             /* .[] */
+  JQ_N_LITERAL,
+  JQ_N_ARRAY,               /* [a] */
+  JQ_N_OBJECT,              /* {k: v, ...} */
+  JQ_N_PIPE,
+  JQ_N_COMMA,
+  JQ_N_ALT,                 /* a // b */
+  JQ_N_AND,
+  JQ_N_OR,
+  JQ_N_BINOP,
+  JQ_N_NEG,
+  JQ_N_TRY,                 /* a? */
+  JQ_N_IF,
+  JQ_N_CALL,
+} jq_kind_t;
+
+typedef enum {
+  JQ_OP_ADD, JQ_OP_SUB, JQ_OP_MUL, JQ_OP_DIV, JQ_OP_MOD,
+  JQ_OP_EQ, JQ_OP_NE, JQ_OP_LT, JQ_OP_LE, JQ_OP_GT, JQ_OP_GE,
+} jq_op_t;
+
+typedef enum {
+  JQ_F_SELECT, JQ_F_LENGTH, JQ_F_KEYS, JQ_F_HAS, JQ_F_NOT, JQ_F_TYPE,
+  JQ_F_EMPTY, JQ_F_ADD, JQ_F_TOSTRING, JQ_F_TONUMBER, JQ_F_STARTSWITH,
+  JQ_F_ENDSWITH, JQ_F_CONTAINS, JQ_F_DOWNCASE, JQ_F_UPCASE, JQ_F_MAP,
+} jq_func_t;
+
+static const struct {
+  const char *name;
+  int args;
+  jq_func_t func;
+} JQ_FUNCS[] = {
+  { "select", 1, JQ_F_SELECT },
+  { "map", 1, JQ_F_MAP },
+  { "length", 0, JQ_F_LENGTH },
+  { "keys", 0, JQ_F_KEYS },
+  { "has", 1, JQ_F_HAS },
+  { "not", 0, JQ_F_NOT },
+  { "type", 0, JQ_F_TYPE },
+  { "empty", 0, JQ_F_EMPTY },
+  { "add", 0, JQ_F_ADD },
+  { "tostring", 0, JQ_F_TOSTRING },
+  { "tonumber", 0, JQ_F_TONUMBER },
+  { "startswith", 1, JQ_F_STARTSWITH },
+  { "endswith", 1, JQ_F_ENDSWITH },
+  { "contains", 1, JQ_F_CONTAINS },
+  { "ascii_downcase", 0, JQ_F_DOWNCASE },
+  { "ascii_upcase", 0, JQ_F_UPCASE },
+};
+
+typedef struct jq_node jq_node_t;
+
+/** A query, parsed into a tree */
+struct jq_node {
+  jq_kind_t kind;
+  int op;                   /* jq_op_t or jq_func_t */
+  jq_node_t *a;             /* Operand; IF: condition */
+  jq_node_t *b;             /* Second operand; IF: then */
+  jq_node_t *c;             /* IF: else, or NULL */
+  const char *name;         /* FIELD */
+  size_t name_len;
+  long long index;          /* INDEX */
+  jq_value_t *value;        /* LITERAL */
+  jq_node_t **keys;         /* OBJECT */
+  jq_node_t **values;
+  size_t count;
+};
+
+
+/** Members of its input a query reads */
+typedef struct {
+  bool all;
+  size_t count;
+  const char *names[JQ_MAX_KEEP];
+  size_t lens[JQ_MAX_KEEP];
+} jq_keep_t;
+
+
+// ---------------------------------------------------------------------------
+// Parsing
+// ---------------------------------------------------------------------------
+
+typedef struct {
+  const char *src;
+  const char *p;
+  jq_arena_t *arena;
+  int failed;
+} jq_parser_t;
+
+
+static jq_node_t *parse_pipe(jq_parser_t *ps);
+static jq_node_t *parse_alt(jq_parser_t *ps);
+static jq_node_t *parse_postfix(jq_parser_t *ps);
+
+
+/**
+ * Report a syntax error at the parser's position (only the first).
+ * @return NULL
+ */
+static jq_node_t *syntax_error(jq_parser_t *ps, const char *what) {
+  if (!ps->failed) {
+    fprintf(stderr, "jq: syntax error: %s at offset %zu of the query\n",
+            what, (size_t)(ps->p - ps->src));
+    ps->failed = 1;
+  }
+  return NULL;
+}
+
+
+static jq_node_t *new_node(jq_parser_t *ps, jq_kind_t kind) {
+  jq_node_t *n = arena_alloc(ps->arena, sizeof(jq_node_t));
+  if (!n) {
+    if (!ps->failed) fprintf(stderr, "jq: out of memory\n");
+    ps->failed = 1;
+    return NULL;
+  }
+  memset(n, 0, sizeof(*n));
+  n->kind = kind;
+  return n;
+}
+
+
+static jq_node_t *new_pair(jq_parser_t *ps, jq_kind_t kind, jq_node_t *a,
+                           jq_node_t *b) {
+  if (!a || !b) return NULL;
+  jq_node_t *n = new_node(ps, kind);
+  if (n) {
+    n->a = a;
+    n->b = b;
+  }
+  return n;
+}
+
+
+static void skip_space(jq_parser_t *ps) {
+  for (;;) {
+    while (*ps->p == ' ' || *ps->p == '\t' || *ps->p == '\n' ||
+           *ps->p == '\r') {
+      ps->p++;
+    }
+    if (*ps->p != '#') return;
+    while (*ps->p && *ps->p != '\n') ps->p++;
+  }
+}
+
+
+/**
+ * Consume a token if it is next.
+ */
+static bool accept(jq_parser_t *ps, const char *token) {
+  skip_space(ps);
+  size_t len = strlen(token);
+  if (strncmp(ps->p, token, len) != 0) return false;
+  /* Keywords must not run on into an identifier */
+  if ((token[0] >= 'a' && token[0] <= 'z') &&
+      (ps->p[len] == '_' || (ps->p[len] >= 'a' && ps->p[len] <= 'z') ||
+       (ps->p[len] >= 'A' && ps->p[len] <= 'Z') ||
+       (ps->p[len] >= '0' && ps->p[len] <= '9'))) {
+    return false;
+  }
+  ps->p += len;
+  return true;
+}
+
+
+static bool is_ident_start(char c) {
+  return c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+
+static bool is_ident_char(char c) {
+  return is_ident_start(c) || (c >= '0' && c <= '9');
+}
+
+
+/**
+ * Parse an identifier at the current position.
+ * @return Its length, or 0 if there is none.
+ */
+static size_t parse_ident(jq_parser_t *ps, const char **name) {
+  if (!is_ident_start(*ps->p)) return 0;
+  const char *start = ps->p;
+  while (is_ident_char(*ps->p)) ps->p++;
+  *name = start;
+  return (size_t)(ps->p - start);
+}
+
+
+/**
+ * Parse a string literal, decoding its escapes as JSON does.
+ * @return The string value, or NULL on error.
+ */
+static jq_value_t *parse_string(jq_parser_t *ps) {
+  const char *start = ps->p;
+  const char *p = start + 1;
+  while (*p && *p != '"') {
+    if (*p == '\\') {
+      if (p[1] == '(') {
+        ps->p = p;
+        syntax_error(ps, "string interpolation is not supported");
+        return NULL;
+      }
+      if (p[1]) p++;
+    }
+    p++;
+  }
+  if (*p != '"') {
+    syntax_error(ps, "unterminated string");
+    return NULL;
+  }
+  ps->p = p + 1;
+
+  jbox_json_reader_t r;
+  jbox_json_reader_init(&r, start, (size_t)(ps->p - start));
+  jq_value_t *v = NULL;
+  if (jbox_json_next(&r) == JBOX_JSON_STRING) {
+    v = arena_alloc(ps->arena, sizeof(jq_value_t));
+    char *copy = arena_alloc(ps->arena, r.text_len + 1);
+    if (v && copy) {
+      memcpy(copy, r.text, r.text_len + 1);
+      *v = (jq_value_t){ .type = JQ_STRING, .str = copy, .len = r.text_len };
+    } else {
+      v = NULL;
+    }
+  }
+  jbox_json_reader_free(&r);
+  if (!v) syntax_error(ps, "invalid string");
+  return v;
+}
+
+
+/**
+ * Parse a number literal.
+ */
+static jq_value_t *parse_number(jq_parser_t *ps) {
+  char *end;
+  double num = strtod(ps->p, &end);
+  jq_value_t *v = arena_alloc(ps->arena, sizeof(jq_value_t));
+  if (!v) return NULL;
+  *v = (jq_value_t){ .type = JQ_NUMBER, .num = num };
+  ps->p = end;
+  return v;
+}
+
+
+/**
+ * Parse what follows '[' in a path: ] (iterate), a number or a string.
+ */
+static jq_node_t *parse_bracket(jq_parser_t *ps) {
+  if (accept(ps, "]")) return new_node(ps, JQ_N_ITERATE);
+  skip_space(ps);
+  jq_node_t *n = NULL;
+  if (*ps->p == '"') {
+    jq_value_t *key = parse_string(ps);
+    if (!key) return NULL;
+    n = new_node(ps, JQ_N_FIELD);
+    if (n) {
+      n->name = key->str;
+      n->name_len = key->len;
+    }
+  } else if (*ps->p == '-' || (*ps->p >= '0' && *ps->p <= '9')) {
+    char *end;
+    long long index = strtoll(ps->p, &end, 10);
+    if (end == ps->p || *end == '.') {
+      return syntax_error(ps, "expected an integer index");
+    }
+    ps->p = end;
+    n = new_node(ps, JQ_N_INDEX);
+    if (n) n->index = index;
+  } else {
+    return syntax_error(ps, "only literal indexes are supported");
+  }
+  if (!accept(ps, "]")) return syntax_error(ps, "expected ']'");
+  return n;
+}
+
+
+/**
+ * Parse the path step after '.': a name, a quoted name or a bracket.
+ * @return The step, or NULL if none follows (a bare '.').
+ */
+static jq_node_t *parse_step(jq_parser_t *ps, bool *found) {
+  *found = true;
+  const char *name;
+  size_t len = parse_ident(ps, &name);
+  if (len > 0) {
+    jq_node_t *n = new_node(ps, JQ_N_FIELD);
+    if (n) {
+      n->name = name;
+      n->name_len = len;
+    }
+    return n;
+  }
+  if (*ps->p == '"') {
+    jq_value_t *key = parse_string(ps);
+    if (!key) return NULL;
+    jq_node_t *n = new_node(ps, JQ_N_FIELD);
+    if (n) {
+      n->name = key->str;
+      n->name_len = key->len;
+    }
+    return n;
+  }
+  if (*ps->p == '[') {
+    ps->p++;
+    return parse_bracket(ps);
+  }
+  *found = false;
+  return NULL;
+}
+
+
+/**
+ * Parse an object construction after '{'.
+ */
+static jq_node_t *parse_object(jq_parser_t *ps) {
+  jq_node_t *n = new_node(ps, JQ_N_OBJECT);
+  if (!n) return NULL;
+  size_t cap = 0;
+  if (accept(ps, "}")) return n;
+
+  do {
+    skip_space(ps);
+    jq_node_t *key = NULL;
+    jq_node_t *value = NULL;
+    const char *name;
+    size_t len;
+    if (*ps->p == '"') {
+      jq_value_t *s = parse_string(ps);
+      if (!s) return NULL;
+      key = new_node(ps, JQ_N_LITERAL);
+      if (!key) return NULL;
+      key->value = s;
+    } else if ((len = parse_ident(ps, &name)) > 0) {
+      jq_value_t *s = arena_alloc(ps->arena, sizeof(jq_value_t));
+      key = new_node(ps, JQ_N_LITERAL);
+      if (!s || !key) return NULL;
+      *s = (jq_value_t){ .type = JQ_STRING, .str = name, .len = len };
+      key->value = s;
+    } else if (accept(ps, "(")) {
+      key = parse_pipe(ps);
+      if (!key) return NULL;
+      if (!accept(ps, ")")) return syntax_error(ps, "expected ')'");
+    } else {
+      return syntax_error(ps, "expected an object key");
+    }
+
+    if (accept(ps, ":")) {
+      value = parse_alt(ps);
+    } else if (key->kind == JQ_N_LITERAL) {
+      /* {name} is short for {name: .name} */
+      value = new_node(ps, JQ_N_FIELD);
+      if (value) {
+        value->name = key->value->str;
+        value->name_len = key->value->len;
+      }
+    } else {
+      return syntax_error(ps, "expected ':'");
+    }
+    if (!value) return NULL;
+
+    if (n->count == cap) {
+      size_t grown = cap ? cap * 2 : 4;
+      jq_node_t **keys = arena_alloc(ps->arena, grown * sizeof(jq_node_t *));
+      jq_node_t **values = arena_alloc(ps->arena,
+                                       grown * sizeof(jq_node_t *));
+      if (!keys || !values) return syntax_error(ps, "out of memory");
+      if (n->count) {
+        memcpy(keys, n->keys, n->count * sizeof(jq_node_t *));
+        memcpy(values, n->values, n->count * sizeof(jq_node_t *));
+      }
+      n->keys = keys;
+      n->values = values;
+      cap = grown;
+    }
+    n->keys[n->count] = key;
+    n->values[n->count] = value;
+    n->count++;
+  } while (accept(ps, ","));
+
+  if (!accept(ps, "}")) return syntax_error(ps, "expected '}'");
+  return n;
+}
+
+
+/**
+ * Parse if COND then A (elif COND then B)* (else C)? end, after "if".
+ */
+static jq_node_t *parse_if(jq_parser_t *ps) {
+  jq_node_t *n = new_node(ps, JQ_N_IF);
+  if (!n) return NULL;
+  n->a = parse_pipe(ps);
+  if (!n->a) return NULL;
+  if (!accept(ps, "then")) return syntax_error(ps, "expected 'then'");
+  n->b = parse_pipe(ps);
+  if (!n->b) return NULL;
+  if (accept(ps, "elif")) {
+    n->c = parse_if(ps);
+    return n->c ? n : NULL;
+  }
+  if (accept(ps, "else")) {
+    n->c = parse_pipe(ps);
+    if (!n->c) return NULL;
+  }
+  if (!accept(ps, "end")) return syntax_error(ps, "expected 'end'");
+  return n;
+}
+
+
+/**
+ * Parse a call of a builtin after its name.
+ */
+static jq_node_t *parse_call(jq_parser_t *ps, const char *name, size_t len) {
+  size_t f = 0;
+  size_t nfuncs = sizeof(JQ_FUNCS) / sizeof(JQ_FUNCS[0]);
+  while (f < nfuncs && (strlen(JQ_FUNCS[f].name) != len ||
+                        strncmp(JQ_FUNCS[f].name, name, len) != 0)) {
+    f++;
+  }
+  if (f == nfuncs) {
+    ps->p = name;
+    return syntax_error(ps, "unknown function");
+  }
+
+  jq_node_t *arg = NULL;
+  if (JQ_FUNCS[f].args > 0) {
+    if (!accept(ps, "(")) return syntax_error(ps, "expected '('");
+    arg = parse_pipe(ps);
+    if (!arg) return NULL;
+    if (!accept(ps, ")")) return syntax_error(ps, "expected ')'");
+  }
+
+  if (JQ_FUNCS[f].func == JQ_F_MAP) {
+    /* map(f) is [.[] | f] */
+    jq_node_t *array = new_node(ps, JQ_N_ARRAY);
+    if (!array) return NULL;
+    array->a = new_pair(ps, JQ_N_PIPE, new_node(ps, JQ_N_ITERATE), arg);
+    return array->a ? array : NULL;
+  }
+  jq_node_t *n = new_node(ps, JQ_N_CALL);
+  if (n) {
+    n->op = JQ_FUNCS[f].func;
+    n->a = arg;
+  }
+  return n;
+}
+
+
+/**
+ * Parse a term: a path, literal, parenthesised query, construction,
+ * if or call.
+ */
+static jq_node_t *parse_term(jq_parser_t *ps) {
+  skip_space(ps);
+  char c = *ps->p;
+
+  if (c == '.') {
+    ps->p++;
+    bool found;
+    jq_node_t *step = parse_step(ps, &found);
+    return found ? step : new_node(ps, JQ_N_IDENTITY);
+  }
+  if (c == '"' || c == '-' || (c >= '0' && c <= '9')) {
+    if (c == '-' && !(ps->p[1] >= '0' && ps->p[1] <= '9')) {
+      return syntax_error(ps, "unexpected '-'");
+    }
+    jq_value_t *v = c == '"' ? parse_string(ps) : parse_number(ps);
+    if (!v) return NULL;
+    jq_node_t *n = new_node(ps, JQ_N_LITERAL);
+    if (n) n->value = v;
+    return n;
+  }
+  if (accept(ps, "(")) {
+    jq_node_t *n = parse_pipe(ps);
+    if (n && !accept(ps, ")")) return syntax_error(ps, "expected ')'");
+    return n;
+  }
+  if (accept(ps, "[")) {
+    jq_node_t *n = new_node(ps, JQ_N_ARRAY);
+    if (!n || accept(ps, "]")) return n;
+    n->a = parse_pipe(ps);
+    if (!n->a) return NULL;
+    if (!accept(ps, "]")) return syntax_error(ps, "expected ']'");
+    return n;
+  }
+  if (accept(ps, "{")) return parse_object(ps);
+  if (accept(ps, "if")) return parse_if(ps);
+
+  const char *name;
+  size_t len = parse_ident(ps, &name);
+  if (len == 0) return syntax_error(ps, "unexpected character");
+  jq_value_t *literal = NULL;
+  if (len == 4 && memcmp(name, "true", 4) == 0) literal = &jq_true;
+  if (len == 5 && memcmp(name, "false", 5) == 0) literal = &jq_false;
+  if (len == 4 && memcmp(name, "null", 4) == 0) literal = &jq_null;
+  if (literal) {
+    jq_node_t *n = new_node(ps, JQ_N_LITERAL);
+    if (n) n->value = literal;
+    return n;
+  }
+  return parse_call(ps, name, len);
+}
+
+
+/**
+ * Parse a term followed by path steps and '?'s.
+ */
+static jq_node_t *parse_postfix(jq_parser_t *ps) {
+  jq_node_t *n = parse_term(ps);
+  while (n) {
+    skip_space(ps);
+    if (*ps->p == '?') {
+      ps->p++;
+      jq_node_t *t = new_node(ps, JQ_N_TRY);
+      if (t) t->a = n;
+      n = t;
+    } else if (*ps->p == '[') {
+      ps->p++;
+      n = new_pair(ps, JQ_N_PIPE, n, parse_bracket(ps));
+    } else if (*ps->p == '.' && (is_ident_start(ps->p[1]) ||
+                                 ps->p[1] == '"' || ps->p[1] == '[')) {
+      ps->p++;
+      bool found;
+      n = new_pair(ps, JQ_N_PIPE, n, parse_step(ps, &found));
+    } else {
+      break;
+    }
+  }
+  return n;
+}
+
+
+static jq_node_t *parse_unary(jq_parser_t *ps) {
+  skip_space(ps);
+  if (*ps->p == '-' && !(ps->p[1] >= '0' && ps->p[1] <= '9')) {
+    ps->p++;
+    jq_node_t *n = new_node(ps, JQ_N_NEG);
+    if (!n) return NULL;
+    n->a = parse_unary(ps);
+    return n->a ? n : NULL;
+  }
+  return parse_postfix(ps);
+}
+
+
+static jq_node_t *new_binop(jq_parser_t *ps, jq_op_t op, jq_node_t *a,
+                            jq_node_t *b) {
+  jq_node_t *n = new_pair(ps, JQ_N_BINOP, a, b);
+  if (n) n->op = op;
+  return n;
+}
+
+
+static jq_node_t *parse_mul(jq_parser_t *ps) {
+  jq_node_t *n = parse_unary(ps);
+  while (n) {
+    skip_space(ps);
+    char c = *ps->p;
+    if ((c != '*' && c != '/' && c != '%') || ps->p[1] == '/') break;
+    ps->p++;
+    jq_op_t op = c == '*' ? JQ_OP_MUL : c == '/' ? JQ_OP_DIV : JQ_OP_MOD;
+    n = new_binop(ps, op, n, parse_unary(ps));
+  }
+  return n;
+}
+
+
+static jq_node_t *parse_add(jq_parser_t *ps) {
+  jq_node_t *n = parse_mul(ps);
+  while (n) {
+    skip_space(ps);
+    char c = *ps->p;
+    if (c != '+' && c != '-') break;
+    ps->p++;
+    n = new_binop(ps, c == '+' ? JQ_OP_ADD : JQ_OP_SUB, n, parse_mul(ps));
+  }
+  return n;
+}
+
+
+static jq_node_t *parse_compare(jq_parser_t *ps) {
+  static const struct { const char *token; jq_op_t op; } ops[] = {
+    { "==", JQ_OP_EQ }, { "!=", JQ_OP_NE }, { "<=", JQ_OP_LE },
+    { ">=", JQ_OP_GE }, { "<", JQ_OP_LT }, { ">", JQ_OP_GT },
+  };
+  jq_node_t *n = parse_add(ps);
+  if (!n) return NULL;
+  for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+    if (accept(ps, ops[i].token)) {
+      return new_binop(ps, ops[i].op, n, parse_add(ps));
+    }
+  }
+  return n;
+}
+
+
+static jq_node_t *parse_and(jq_parser_t *ps) {
+  jq_node_t *n = parse_compare(ps);
+  while (n && accept(ps, "and")) {
+    n = new_pair(ps, JQ_N_AND, n, parse_compare(ps));
+  }
+  return n;
+}
+
+
+static jq_node_t *parse_or(jq_parser_t *ps) {
+  jq_node_t *n = parse_and(ps);
+  while (n && accept(ps, "or")) {
+    n = new_pair(ps, JQ_N_OR, n, parse_and(ps));
+  }
+  return n;
+}
+
+
+static jq_node_t *parse_alt(jq_parser_t *ps) {
+  jq_node_t *n = parse_or(ps);
+  if (n && accept(ps, "//")) return new_pair(ps, JQ_N_ALT, n, parse_alt(ps));
+  return n;
+}
+
+
+static jq_node_t *parse_comma(jq_parser_t *ps) {
+  jq_node_t *n = parse_alt(ps);
+  while (n && accept(ps, ",")) {
+    n = new_pair(ps, JQ_N_COMMA, n, parse_alt(ps));
+  }
+  return n;
+}
+
+
+static jq_node_t *parse_pipe(jq_parser_t *ps) {
+  jq_node_t *n = parse_comma(ps);
+  if (n && accept(ps, "|")) return new_pair(ps, JQ_N_PIPE, n, parse_pipe(ps));
+  return n;
+}
+
+
+/**
+ * Parse a whole query.
+ * @return The tree, or NULL after printing a syntax error.
+ */
+static jq_node_t *parse_query(const char *src, jq_arena_t *arena) {
+  jq_parser_t ps = { .src = src, .p = src, .arena = arena };
+  jq_node_t *n = parse_pipe(&ps);
+  skip_space(&ps);
+  if (n && *ps.p != '\0') return syntax_error(&ps, "unexpected input");
+  return ps.failed ? NULL : n;
+}
+
+
+// ---------------------------------------------------------------------------
+// Analysis
+// ---------------------------------------------------------------------------
+
+static void keep_add(jq_keep_t *keep, const char *name, size_t len) {
+  if (keep->all) return;
+  for (size_t i = 0; i < keep->count; i++) {
+    if (keep->lens[i] == len && memcmp(keep->names[i], name, len) == 0) {
+      return;
+    }
+  }
+  if (keep->count == JQ_MAX_KEEP) {
+    keep->all = true;
+    return;
+  }
+  keep->names[keep->count] = name;
+  keep->lens[keep->count++] = len;
+}
+
+
+static void keep_union(jq_keep_t *keep, const jq_keep_t *other) {
+  if (other->all) keep->all = true;
+  for (size_t i = 0; i < other->count; i++) {
+    keep_add(keep, other->names[i], other->lens[i]);
+  }
+}
+
+
+/**
+ * Work out which members of its input a query reads.
+ * @param n Query
+ * @param pass What reads the query's output where that output is its
+ *        input (through ., select and the like)
+ * @param keep Members read; added to
+ */
+static void query_reads(const jq_node_t *n, const jq_keep_t *pass,
+                        jq_keep_t *keep) {
+  static const jq_keep_t all = { .all = true };
+  static const jq_keep_t none = { .all = false };
+
+  switch (n->kind) {
+    case JQ_N_IDENTITY:
+      keep_union(keep, pass);
+      break;
+    case JQ_N_FIELD:
+      keep_add(keep, n->name, n->name_len);
+      break;
+    case JQ_N_LITERAL:
+      break;
+    case JQ_N_PIPE: {
+      jq_keep_t inner = { .all = false };
+      query_reads(n->b, pass, &inner);
+      query_reads(n->a, &inner, keep);
+      break;
+    }
+    case JQ_N_COMMA:
+    case JQ_N_ALT:
+      query_reads(n->a, pass, keep);
+      query_reads(n->b, pass, keep);
+      break;
+    case JQ_N_TRY:
+      query_reads(n->a, pass, keep);
+      break;
+    case JQ_N_IF:
+      /* The condition only needs to be true or not */
+      query_reads(n->a, &none, keep);
+      query_reads(n->b, pass, keep);
+      if (n->c) query_reads(n->c, pass, keep);
+      else keep_union(keep, pass);
+      break;
+    case JQ_N_CALL:
+      if (n->op == JQ_F_SELECT) {
+        query_reads(n->a, &none, keep);
+        keep_union(keep, pass);
+      } else if (n->op == JQ_F_NOT || n->op == JQ_F_TYPE ||
+                 n->op == JQ_F_EMPTY) {
+        /* The type of a pruned value is the same */
+      } else {
+        keep->all = true;
+      }
+      break;
+    case JQ_N_ARRAY:
+    case JQ_N_OBJECT:
+    case JQ_N_AND:
+    case JQ_N_OR:
+    case JQ_N_BINOP:
+    case JQ_N_NEG:
+      if (n->a) query_reads(n->a, &all, keep);
+      if (n->b) query_reads(n->b, &all, keep);
+      for (size_t i = 0; i < n->count; i++) {
+        query_reads(n->keys[i], &all, keep);
+        query_reads(n->values[i], &all, keep);
+      }
+      break;
+    case JQ_N_INDEX:
+    case JQ_N_ITERATE:
+      keep->all = true;
+      break;
+  }
+}
+
+
+/**
+ * Split a query that starts with .[] into what follows it.
+ * @return The rest (. if nothing follows), or NULL if it does not start
+ *         with .[].
+ */
+static jq_node_t *split_iterate(jq_node_t *n, jq_arena_t *arena) {
+  if (n->kind == JQ_N_ITERATE ||
+      (n->kind == JQ_N_TRY && n->a->kind == JQ_N_ITERATE)) {
+    jq_node_t *id = arena_alloc(arena, sizeof(jq_node_t));
+    if (id) {
+      memset(id, 0, sizeof(*id));
+      id->kind = JQ_N_IDENTITY;
+    }
+    return id;
+  }
+  if (n->kind != JQ_N_PIPE) return NULL;
+  jq_node_t *rest = split_iterate(n->a, arena);
+  if (!rest) return NULL;
+  if (rest->kind == JQ_N_IDENTITY) return n->b;
+  jq_node_t *pipe = arena_alloc(arena, sizeof(jq_node_t));
+  if (!pipe) return NULL;
+  memset(pipe, 0, sizeof(*pipe));
+  pipe->kind = JQ_N_PIPE;
+  pipe->a = rest;
+  pipe->b = n->b;
+  return pipe;
+}
+
+
+// ---------------------------------------------------------------------------
+// Evaluation
+// ---------------------------------------------------------------------------
+
+/** State of one run */
+typedef struct {
+  jq_arena_t values;        /* Reset after each input value */
+  char error[256];
+  FILE *out;
+  int compact;
+  int raw;
+} jq_run_t;
+
+/** Receives each output of a query; nonzero stops it */
+typedef int (*jq_emit_fn)(jq_run_t *run, void *arg, jq_value_t *v);
+
+/** Outputs gathered into an array */
+typedef struct {
+  jq_value_t **items;
+  size_t len;
+  size_t cap;
+} jq_list_t;
+
+
+static int eval(jq_run_t *run, const jq_node_t *n, jq_value_t *in,
+                jq_emit_fn emit, void *arg);
+
+
+/**
+ * Record a runtime error.
+ * @return -1
+ */
+static int fail(jq_run_t *run, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(run->error, sizeof(run->error), fmt, ap);
+  va_end(ap);
+  return -1;
+}
+
+
+static bool truthy(const jq_value_t *v) {
+  return v->type != JQ_NULL && v->type != JQ_FALSE;
+}
+
+
+static jq_value_t *new_value(jq_run_t *run, jq_type_t type) {
+  jq_value_t *v = arena_alloc(&run->values, sizeof(jq_value_t));
+  if (v) *v = (jq_value_t){ .type = type };
+  return v;
+}
+
+
+static jq_value_t *new_number(jq_run_t *run, double num) {
+  jq_value_t *v = new_value(run, JQ_NUMBER);
+  if (v) v->num = num;
+  return v;
+}
+
+
+static jq_value_t *new_string(jq_run_t *run, const char *s, size_t len) {
+  jq_value_t *v = new_value(run, JQ_STRING);
+  char *copy = arena_alloc(&run->values, len + 1);
+  if (!v || !copy) return NULL;
+  memcpy(copy, s, len);
+  copy[len] = '\0';
+  v->str = copy;
+  v->len = len;
+  return v;
+}
+
+
+static int collect_emit(jq_run_t *run, void *arg, jq_value_t *v) {
+  jq_list_t *list = arg;
+  if (list->len == list->cap) {
+    size_t cap = list->cap ? list->cap * 2 : 8;
+    jq_value_t **items = realloc(list->items, cap * sizeof(jq_value_t *));
+    if (!items) return fail(run, "out of memory");
+    list->items = items;
+    list->cap = cap;
+  }
+  list->items[list->len++] = v;
+  return 0;
+}
+
+
+/**
+ * Gather all outputs of a query.
+ * @return 0, or -1 on error (the list is still to be freed).
+ */
+static int collect(jq_run_t *run, const jq_node_t *n, jq_value_t *in,
+                   jq_list_t *list) {
+  return eval(run, n, in, collect_emit, list);
+}
+
+
+/**
+ * Find a member, the last one if the key repeats.
+ */
+static jq_value_t *object_get(const jq_value_t *obj, const char *key,
+                              size_t len) {
+  for (size_t i = obj->len; i-- > 0;) {
+    const jq_member_t *m = &obj->members[i];
+    if (m->key_len == len && memcmp(m->key, key, len) == 0) return m->value;
+  }
+  return NULL;
+}
+
+
+static int compare_values(const jq_value_t *a, const jq_value_t *b);
+
+
+static int compare_members(const void *x, const void *y) {
+  const jq_member_t *a = *(const jq_member_t *const *)x;
+  const jq_member_t *b = *(const jq_member_t *const *)y;
+  size_t n = a->key_len < b->key_len ? a->key_len : b->key_len;
+  int c = memcmp(a->key, b->key, n);
+  if (c != 0) return c;
+  return (a->key_len > b->key_len) - (a->key_len < b->key_len);
+}
+
+
+/**
+ * Members of an object sorted by key, for keys and comparisons.
+ * @return Array of pointers (to free), or NULL if out of memory.
+ */
+static const jq_member_t **sorted_members(const jq_value_t *obj) {
+  const jq_member_t **sorted = malloc((obj->len ? obj->len : 1) *
+                                      sizeof(jq_member_t *));
+  if (!sorted) return NULL;
+  for (size_t i = 0; i < obj->len; i++) sorted[i] = &obj->members[i];
+  qsort(sorted, obj->len, sizeof(jq_member_t *), compare_members);
+  return sorted;
+}
+
+
+/**
+ * Order two values as jq sorts them: by type, then by value; objects by
+ * their sorted keys, then by the values of those keys.
+ */
+static int compare_values(const jq_value_t *a, const jq_value_t *b) {
+  if (a->type != b->type) return a->type < b->type ? -1 : 1;
+  switch (a->type) {
+    case JQ_NULL:
+    case JQ_FALSE:
+    case JQ_TRUE:
+      return 0;
+    case JQ_NUMBER:
+      return (a->num > b->num) - (a->num < b->num);
+    case JQ_STRING: {
+      size_t n = a->len < b->len ? a->len : b->len;
+      int c = memcmp(a->str, b->str, n);
+      if (c != 0) return c < 0 ? -1 : 1;
+      return (a->len > b->len) - (a->len < b->len);
+    }
+    case JQ_ARRAY:
+      for (size_t i = 0; i < a->len && i < b->len; i++) {
+        int c = compare_values(a->items[i], b->items[i]);
+        if (c != 0) return c;
+      }
+      return (a->len > b->len) - (a->len < b->len);
+    case JQ_OBJECT: {
+      const jq_member_t **sa = sorted_members(a);
+      const jq_member_t **sb = sorted_members(b);
+      int c = 0;
+      if (!sa || !sb) {
+        c = (a->len > b->len) - (a->len < b->len);
+      } else {
+        for (size_t i = 0; c == 0 && i < a->len && i < b->len; i++) {
+          c = compare_members(&sa[i], &sb[i]);
+        }
+        if (c == 0) c = (a->len > b->len) - (a->len < b->len);
+        for (size_t i = 0; c == 0 && i < a->len; i++) {
+          c = compare_values(sa[i]->value, sb[i]->value);
+        }
+      }
+      free(sa);
+      free(sb);
+      return c;
+    }
+  }
+  return 0;
+}
+
+
+/**
+ * Whether b is contained in a, as jq's contains() defines it.
+ */
+static bool value_contains(const jq_value_t *a, const jq_value_t *b) {
+  if (a->type == JQ_OBJECT && b->type == JQ_OBJECT) {
+    for (size_t i = 0; i < b->len; i++) {
+      const jq_member_t *m = &b->members[i];
+      jq_value_t *have = object_get(a, m->key, m->key_len);
+      if (!have || !value_contains(have, m->value)) return false;
+    }
+    return true;
+  }
+  if (a->type == JQ_ARRAY && b->type == JQ_ARRAY) {
+    for (size_t i = 0; i < b->len; i++) {
+      bool found = false;
+      for (size_t j = 0; j < a->len && !found; j++) {
+        found = value_contains(a->items[j], b->items[i]);
+      }
+      if (!found) return false;
+    }
+    return true;
+  }
+  if (a->type == JQ_STRING && b->type == JQ_STRING) {
+    return b->len == 0 || memmem(a->str, a->len, b->str, b->len) != NULL;
+  }
+  return compare_values(a, b) == 0;
+}
+
+
+/**
+ * Build an array or object from parts in the values arena.
+ */
+static jq_value_t *new_array(jq_run_t *run, jq_value_t **items, size_t len) {
+  jq_value_t *v = new_value(run, JQ_ARRAY);
+  if (!v) return NULL;
+  v->items = arena_alloc(&run->values, (len ? len : 1) * sizeof(*items));
+  if (!v->items) return NULL;
+  if (len) memcpy(v->items, items, len * sizeof(*items));
+  v->len = len;
+  return v;
+}
+
+
+/**
+ * Put a member into an object being built, replacing one with the same
+ * key; members has room for one more.
+ */
+static void object_set(jq_member_t *members, size_t *len, const char *key,
+                       size_t key_len, jq_value_t *value) {
+  for (size_t i = 0; i < *len; i++) {
+    if (members[i].key_len == key_len &&
+        memcmp(members[i].key, key, key_len) == 0) {
+      members[i].value = value;
+      return;
+    }
+  }
+  members[(*len)++] = (jq_member_t){ key, key_len, value };
+}
+
+
+static int write_value(jq_run_t *run, FILE *out, const jq_value_t *v,
+                       int depth, int compact);
+
+
+/**
+ * Apply an arithmetic or comparison operator.
+ * @return The result, or NULL after recording an error.
+ */
+static jq_value_t *binop(jq_run_t *run, jq_op_t op, jq_value_t *a,
+                         jq_value_t *b) {
+  switch (op) {
+    case JQ_OP_EQ: return compare_values(a, b) == 0 ? &jq_true : &jq_false;
+    case JQ_OP_NE: return compare_values(a, b) != 0 ? &jq_true : &jq_false;
+    case JQ_OP_LT: return compare_values(a, b) < 0 ? &jq_true : &jq_false;
+    case JQ_OP_LE: return compare_values(a, b) <= 0 ? &jq_true : &jq_false;
+    case JQ_OP_GT: return compare_values(a, b) > 0 ? &jq_true : &jq_false;
+    case JQ_OP_GE: return compare_values(a, b) >= 0 ? &jq_true : &jq_false;
+    default: break;
+  }
+
+  if (a->type == JQ_NUMBER && b->type == JQ_NUMBER) {
+    double x = a->num, y = b->num;
+    switch (op) {
+      case JQ_OP_ADD: return new_number(run, x + y);
+      case JQ_OP_SUB: return new_number(run, x - y);
+      case JQ_OP_MUL: return new_number(run, x * y);
+      case JQ_OP_DIV:
+        if (y == 0) {
+          fail(run, "%g and %g cannot be divided because the divisor is "
+                    "zero", x, y);
+          return NULL;
+        }
+        return new_number(run, x / y);
+      case JQ_OP_MOD: {
+        long long d = (long long)y;
+        if (d == 0) {
+          fail(run, "%g and %g cannot be divided because the divisor is "
+                    "zero", x, y);
+          return NULL;
+        }
+        d = d < 0 ? -d : d;
+        return new_number(run, (double)((long long)x % d));
+      }
+      default: break;
+    }
+  }
+
+  if (op == JQ_OP_ADD) {
+    if (a->type == JQ_NULL) return b;
+    if (b->type == JQ_NULL) return a;
+    if (a->type == JQ_STRING && b->type == JQ_STRING) {
+      jq_value_t *v = new_value(run, JQ_STRING);
+      char *s = arena_alloc(&run->values, a->len + b->len + 1);
+      if (!v || !s) return NULL;
+      memcpy(s, a->str, a->len);
+      memcpy(s + a->len, b->str, b->len);
+      s[a->len + b->len] = '\0';
+      v->str = s;
+      v->len = a->len + b->len;
+      return v;
+    }
+    if (a->type == JQ_ARRAY && b->type == JQ_ARRAY) {
+      jq_value_t *v = new_array(run, a->items, a->len);
+      jq_value_t **items = arena_alloc(&run->values, (a->len + b->len + 1) *
+                                                     sizeof(jq_value_t *));
+      if (!v || !items) return NULL;
+      memcpy(items, a->items, a->len * sizeof(jq_value_t *));
+      memcpy(items + a->len, b->items, b->len * sizeof(jq_value_t *));
+      v->items = items;
+      v->len = a->len + b->len;
+      return v;
+    }
+    if (a->type == JQ_OBJECT && b->type == JQ_OBJECT) {
+      jq_value_t *v = new_value(run, JQ_OBJECT);
+      jq_member_t *m = arena_alloc(&run->values, (a->len + b->len + 1) *
+                                                 sizeof(jq_member_t));
+      if (!v || !m) return NULL;
+      size_t len = 0;
+      for (size_t i = 0; i < a->len; i++) {
+        object_set(m, &len, a->members[i].key, a->members[i].key_len,
+                   a->members[i].value);
+      }
+      for (size_t i = 0; i < b->len; i++) {
+        object_set(m, &len, b->members[i].key, b->members[i].key_len,
+                   b->members[i].value);
+      }
+      v->members = m;
+      v->len = len;
+      return v;
+    }
+  }
+  if (op == JQ_OP_SUB && a->type == JQ_ARRAY && b->type == JQ_ARRAY) {
+    jq_value_t *v = new_array(run, a->items, a->len);
+    if (!v) return NULL;
+    size_t len = 0;
+    for (size_t i = 0; i < a->len; i++) {
+      bool drop = false;
+      for (size_t j = 0; j < b->len && !drop; j++) {
+        drop = compare_values(a->items[i], b->items[j]) == 0;
+      }
+      if (!drop) v->items[len++] = a->items[i];
+    }
+    v->len = len;
+    return v;
+  }
+  if (op == JQ_OP_DIV && a->type == JQ_STRING && b->type == JQ_STRING) {
+    /* Split a at each b */
+    jq_list_t parts = {0};
+    const char *p = a->str, *end = a->str + a->len;
+    while (a->len > 0) {
+      const char *hit = b->len ? memmem(p, (size_t)(end - p), b->str, b->len)
+                               : NULL;
+      const char *stop = hit ? hit : end;
+      jq_value_t *part = new_string(run, p, (size_t)(stop - p));
+      if (!part || collect_emit(run, &parts, part) != 0) {
+        free(parts.items);
+        return NULL;
+      }
+      if (!hit) break;
+      p = hit + b->len;
+    }
+    jq_value_t *v = new_array(run, parts.items, parts.len);
+    free(parts.items);
+    return v;
+  }
+
+  static const char *const names[] = {
+    "added", "subtracted", "multiplied", "divided", "divided",
+  };
+  fail(run, "%s and %s cannot be %s", TYPE_NAMES[a->type],
+       TYPE_NAMES[b->type], names[op]);
+  return NULL;
+}
+
+
+/** Continuation of a pipe: run the right side on each left output */
+typedef struct {
+  const jq_node_t *next;
+  jq_emit_fn emit;
+  void *arg;
+} jq_pipe_t;
+
+static int pipe_emit(jq_run_t *run, void *arg, jq_value_t *v) {
+  jq_pipe_t *pipe = arg;
+  return eval(run, pipe->next, v, pipe->emit, pipe->arg);
+}
+
+
+/** Passes outputs on, noting whether an error came from further on */
+typedef struct {
+  jq_emit_fn emit;
+  void *arg;
+  int downstream_failed;
+} jq_try_t;
+
+static int try_emit(jq_run_t *run, void *arg, jq_value_t *v) {
+  jq_try_t *t = arg;
+  int rc = t->emit(run, t->arg, v);
+  if (rc != 0) t->downstream_failed = 1;
+  return rc;
+}
+
+
+/**
+ * Build the objects of {k: v, ...} for every combination of the outputs
+ * of its keys and values.
+ */
+static int build_object(jq_run_t *run, const jq_node_t *n, jq_value_t *in,
+                        size_t i, jq_member_t *members, size_t len,
+                        jq_emit_fn emit, void *arg) {
+  if (i == n->count) {
+    jq_value_t *v = new_value(run, JQ_OBJECT);
+    jq_member_t *copy = arena_alloc(&run->values,
+                                    (len ? len : 1) * sizeof(jq_member_t));
+    if (!v || !copy) return fail(run, "out of memory");
+    memcpy(copy, members, len * sizeof(jq_member_t));
+    v->members = copy;
+    v->len = len;
+    return emit(run, arg, v);
+  }
+
+  jq_list_t keys = {0}, values = {0};
+  int rc = collect(run, n->keys[i], in, &keys);
+  if (rc == 0) rc = collect(run, n->values[i], in, &values);
+  for (size_t k = 0; rc == 0 && k < keys.len; k++) {
+    jq_value_t *key = keys.items[k];
+    if (key->type != JQ_STRING) {
+      rc = fail(run, "Object keys must be strings");
+      break;
+    }
+    for (size_t j = 0; rc == 0 && j < values.len; j++) {
+      size_t next_len = len;
+      jq_member_t saved = members[len];
+      object_set(members, &next_len, key->str, key->len, values.items[j]);
+      rc = build_object(run, n, in, i + 1, members, next_len, emit, arg);
+      members[len] = saved;
+    }
+  }
+  free(keys.items);
+  free(values.items);
+  return rc;
+}
+
+
+/**
+ * Length in code points of UTF-8 text.
+ */
+static size_t utf8_length(const char *s, size_t len) {
+  size_t n = 0;
+  for (size_t i = 0; i < len; i++) n += ((unsigned char)s[i] & 0xc0) != 0x80;
+  return n;
+}
+
+
+/**
+ * Run a builtin without arguments on its input.
+ * @return The result, or NULL after recording an error (or for empty).
+ */
+static jq_value_t *call0(jq_run_t *run, jq_func_t f, jq_value_t *in) {
+  switch (f) {
+    case JQ_F_LENGTH:
+      switch (in->type) {
+        case JQ_NULL: return new_number(run, 0);
+        case JQ_NUMBER: return new_number(run, fabs(in->num));
+        case JQ_STRING:
+          return new_number(run, (double)utf8_length(in->str, in->len));
+        case JQ_ARRAY:
+        case JQ_OBJECT: return new_number(run, (double)in->len);
+        default: break;
+      }
+      fail(run, "%s has no length", TYPE_NAMES[in->type]);
+      return NULL;
+    case JQ_F_KEYS: {
+      if (in->type != JQ_OBJECT && in->type != JQ_ARRAY) {
+        fail(run, "%s has no keys", TYPE_NAMES[in->type]);
+        return NULL;
+      }
+      jq_value_t *v = new_array(run, NULL, 0);
+      jq_value_t **items = arena_alloc(&run->values, (in->len ? in->len : 1)
+                                                     * sizeof(jq_value_t *));
+      if (!v || !items) return NULL;
+      v->items = items;
+      v->len = in->len;
+      if (in->type == JQ_ARRAY) {
+        for (size_t i = 0; i < in->len; i++) {
+          if (!(items[i] = new_number(run, (double)i))) return NULL;
+        }
+        return v;
+      }
+      const jq_member_t **sorted = sorted_members(in);
+      if (!sorted) return NULL;
+      for (size_t i = 0; i < in->len; i++) {
+        items[i] = new_string(run, sorted[i]->key, sorted[i]->key_len);
+        if (!items[i]) {
+          free(sorted);
+          return NULL;
+        }
+      }
+      free(sorted);
+      return v;
+    }
+    case JQ_F_NOT:
+      return truthy(in) ? &jq_false : &jq_true;
+    case JQ_F_TYPE: {
+      const char *name = TYPE_NAMES[in->type];
+      return new_string(run, name, strlen(name));
+    }
+    case JQ_F_ADD: {
+      if (in->type == JQ_OBJECT) {
+        jq_value_t *sum = &jq_null;
+        for (size_t i = 0; sum && i < in->len; i++) {
+          sum = binop(run, JQ_OP_ADD, sum, in->members[i].value);
+        }
+        return sum;
+      }
+      if (in->type != JQ_ARRAY) {
+        fail(run, "Cannot iterate over %s", TYPE_NAMES[in->type]);
+        return NULL;
+      }
+      jq_value_t *sum = &jq_null;
+      for (size_t i = 0; sum && i < in->len; i++) {
+        sum = binop(run, JQ_OP_ADD, sum, in->items[i]);
+      }
+      return sum;
+    }
+    case JQ_F_TOSTRING: {
+      if (in->type == JQ_STRING) return in;
+      char *text = NULL;
+      size_t len = 0;
+      FILE *mem = open_memstream(&text, &len);
+      if (!mem) return NULL;
+      write_value(run, mem, in, 0, 1);
+      fclose(mem);
+      jq_value_t *v = text ? new_string(run, text, len) : NULL;
+      free(text);
+      return v;
+    }
+    case JQ_F_TONUMBER: {
+      if (in->type == JQ_NUMBER) return in;
+      if (in->type == JQ_STRING && in->len > 0) {
+        char *end;
+        double num = strtod(in->str, &end);
+        if (end == in->str + in->len) return new_number(run, num);
+      }
+      fail(run, "%s cannot be parsed as a number", TYPE_NAMES[in->type]);
+      return NULL;
+    }
+    case JQ_F_DOWNCASE:
+    case JQ_F_UPCASE: {
+      if (in->type != JQ_STRING) {
+        fail(run, "%s cannot be case-converted", TYPE_NAMES[in->type]);
+        return NULL;
+      }
+      jq_value_t *v = new_string(run, in->str, in->len);
+      if (!v) return NULL;
+      char *s = (char *)v->str;
+      for (size_t i = 0; i < v->len; i++) {
+        if (f == JQ_F_DOWNCASE && s[i] >= 'A' && s[i] <= 'Z') s[i] += 32;
+        if (f == JQ_F_UPCASE && s[i] >= 'a' && s[i] <= 'z') s[i] -= 32;
+      }
+      return v;
+    }
+    default:
+      return NULL;
+  }
+}
+
+
+/**
+ * Run a builtin with one argument value on its input.
+ */
+static jq_value_t *call1(jq_run_t *run, jq_func_t f, jq_value_t *in,
+                         jq_value_t *x) {
+  switch (f) {
+    case JQ_F_HAS:
+      if (in->type == JQ_OBJECT && x->type == JQ_STRING) {
+        return object_get(in, x->str, x->len) ? &jq_true : &jq_false;
+      }
+      if (in->type == JQ_ARRAY && x->type == JQ_NUMBER) {
+        return x->num >= 0 && x->num < (double)in->len ? &jq_true : &jq_false;
+      }
+      fail(run, "Cannot check whether %s has a %s key", TYPE_NAMES[in->type],
+           TYPE_NAMES[x->type]);
+      return NULL;
+    case JQ_F_STARTSWITH:
+    case JQ_F_ENDSWITH:
+      if (in->type != JQ_STRING || x->type != JQ_STRING) {
+        fail(run, "%s() requires string inputs",
+             f == JQ_F_STARTSWITH ? "startswith" : "endswith");
+        return NULL;
+      }
+      if (x->len > in->len) return &jq_false;
+      if (f == JQ_F_STARTSWITH) {
+        return memcmp(in->str, x->str, x->len) == 0 ? &jq_true : &jq_false;
+      }
+      return memcmp(in->str + in->len - x->len, x->str, x->len) == 0
+             ? &jq_true : &jq_false;
+    case JQ_F_CONTAINS:
+      if (in->type != x->type &&
+          !(in->type <= JQ_TRUE && x->type <= JQ_TRUE)) {
+        fail(run, "%s and %s cannot have their containment checked",
+             TYPE_NAMES[in->type], TYPE_NAMES[x->type]);
+        return NULL;
+      }
+      return value_contains(in, x) ? &jq_true : &jq_false;
+    default:
+      return NULL;
+  }
+}
+
+
+/**
+ * Evaluate a query on one input, passing each output to emit.
+ * @return 0, or nonzero after an error (in run->error) or when emit
+ *         stops it.
+ */
+static int eval(jq_run_t *run, const jq_node_t *n, jq_value_t *in,
+                jq_emit_fn emit, void *arg) {
+  switch (n->kind) {
+    case JQ_N_IDENTITY:
+      return emit(run, arg, in);
+
+    case JQ_N_FIELD: {
+      if (in->type == JQ_NULL) return emit(run, arg, &jq_null);
+      if (in->type != JQ_OBJECT) {
+        return fail(run, "Cannot index %s with \"%.*s\"",
+                    TYPE_NAMES[in->type], (int)n->name_len, n->name);
+      }
+      jq_value_t *v = object_get(in, n->name, n->name_len);
+      return emit(run, arg, v ? v : &jq_null);
+    }
+
+    case JQ_N_INDEX: {
+      if (in->type == JQ_NULL) return emit(run, arg, &jq_null);
+      if (in->type != JQ_ARRAY) {
+        return fail(run, "Cannot index %s with number", TYPE_NAMES[in->type]);
+      }
+      long long i = n->index < 0 ? (long long)in->len + n->index : n->index;
+      bool inside = i >= 0 && (unsigned long long)i < in->len;
+      return emit(run, arg, inside ? in->items[i] : &jq_null);
+    }
+
+    case JQ_N_ITERATE:
+      if (in->type == JQ_ARRAY) {
+        for (size_t i = 0; i < in->len; i++) {
+          int rc = emit(run, arg, in->items[i]);
+          if (rc != 0) return rc;
+        }
+        return 0;
+      }
+      if (in->type == JQ_OBJECT) {
+        for (size_t i = 0; i < in->len; i++) {
+          int rc = emit(run, arg, in->members[i].value);
+          if (rc != 0) return rc;
+        }
+        return 0;
+      }
+      return fail(run, "Cannot iterate over %s", TYPE_NAMES[in->type]);
+
+    case JQ_N_LITERAL:
+      return emit(run, arg, n->value);
+
+    case JQ_N_ARRAY: {
+      jq_list_t list = {0};
+      int rc = n->a ? collect(run, n->a, in, &list) : 0;
+      jq_value_t *v = rc == 0 ? new_array(run, list.items, list.len) : NULL;
+      free(list.items);
+      if (rc != 0) return rc;
+      return v ? emit(run, arg, v) : fail(run, "out of memory");
+    }
+
+    case JQ_N_OBJECT: {
+      jq_member_t *members = malloc((n->count + 1) * sizeof(jq_member_t));
+      if (!members) return fail(run, "out of memory");
+      int rc = build_object(run, n, in, 0, members, 0, emit, arg);
+      free(members);
+      return rc;
+    }
+
+    case JQ_N_PIPE: {
+      jq_pipe_t pipe = { n->b, emit, arg };
+      return eval(run, n->a, in, pipe_emit, &pipe);
+    }
+
+    case JQ_N_COMMA: {
+      int rc = eval(run, n->a, in, emit, arg);
+      return rc != 0 ? rc : eval(run, n->b, in, emit, arg);
+    }
+
+    case JQ_N_ALT: {
+      /* Errors on the left count as no output */
+      jq_list_t list = {0};
+      collect(run, n->a, in, &list);
+      int rc = 0;
+      int any = 0;
+      for (size_t i = 0; rc == 0 && i < list.len; i++) {
+        if (!truthy(list.items[i])) continue;
+        any = 1;
+        rc = emit(run, arg, list.items[i]);
+      }
+      free(list.items);
+      if (rc != 0 || any) return rc;
+      return eval(run, n->b, in, emit, arg);
+    }
+
+    case JQ_N_AND:
+    case JQ_N_OR: {
+      jq_list_t left = {0};
+      int rc = collect(run, n->a, in, &left);
+      for (size_t i = 0; rc == 0 && i < left.len; i++) {
+        bool t = truthy(left.items[i]);
+        if (n->kind == JQ_N_AND ? !t : t) {
+          rc = emit(run, arg, t ? &jq_true : &jq_false);
+          continue;
+        }
+        jq_list_t right = {0};
+        rc = collect(run, n->b, in, &right);
+        for (size_t j = 0; rc == 0 && j < right.len; j++) {
+          rc = emit(run, arg, truthy(right.items[j]) ? &jq_true : &jq_false);
+        }
+        free(right.items);
+      }
+      free(left.items);
+      return rc;
+    }
+
+    case JQ_N_BINOP: {
+      jq_list_t left = {0}, right = {0};
+      int rc = collect(run, n->b, in, &right);
+      if (rc == 0) rc = collect(run, n->a, in, &left);
+      for (size_t j = 0; rc == 0 && j < right.len; j++) {
+        for (size_t i = 0; rc == 0 && i < left.len; i++) {
+          jq_value_t *v = binop(run, n->op, left.items[i], right.items[j]);
+          rc = v ? emit(run, arg, v) : -1;
+        }
+      }
+      free(left.items);
+      free(right.items);
+      return rc;
+    }
+
+    case JQ_N_NEG: {
+      jq_list_t list = {0};
+      int rc = collect(run, n->a, in, &list);
+      for (size_t i = 0; rc == 0 && i < list.len; i++) {
+        if (list.items[i]->type != JQ_NUMBER) {
+          rc = fail(run, "%s cannot be negated",
+                    TYPE_NAMES[list.items[i]->type]);
+          break;
+        }
+        jq_value_t *v = new_number(run, -list.items[i]->num);
+        rc = v ? emit(run, arg, v) : fail(run, "out of memory");
+      }
+      free(list.items);
+      return rc;
+    }
+
+    case JQ_N_TRY: {
+      jq_try_t t = { emit, arg, 0 };
+      int rc = eval(run, n->a, in, try_emit, &t);
+      return t.downstream_failed ? rc : 0;
+    }
+
+    case JQ_N_IF: {
+      jq_list_t conds = {0};
+      int rc = collect(run, n->a, in, &conds);
+      for (size_t i = 0; rc == 0 && i < conds.len; i++) {
+        if (truthy(conds.items[i])) rc = eval(run, n->b, in, emit, arg);
+        else if (n->c) rc = eval(run, n->c, in, emit, arg);
+        else rc = emit(run, arg, in);
+      }
+      free(conds.items);
+      return rc;
+    }
+
+    case JQ_N_CALL: {
+      if (n->op == JQ_F_EMPTY) return 0;
+      if (!n->a) {
+        jq_value_t *v = call0(run, n->op, in);
+        return v ? emit(run, arg, v) : -1;
+      }
+      jq_list_t args = {0};
+      int rc = collect(run, n->a, in, &args);
+      for (size_t i = 0; rc == 0 && i < args.len; i++) {
+        if (n->op == JQ_F_SELECT) {
+          if (truthy(args.items[i])) rc = emit(run, arg, in);
+          continue;
+        }
+        jq_value_t *v = call1(run, n->op, in, args.items[i]);
+        rc = v ? emit(run, arg, v) : -1;
+      }
+      free(args.items);
+      return rc;
+    }
+  }
+  return 0;
+}
+
+
+// ---------------------------------------------------------------------------
+// Input and output
+// ---------------------------------------------------------------------------
+
+static void write_indent(FILE *out, int depth) {
+  putc('\n', out);
+  for (int i = 0; i < depth; i++) fputs("  ", out);
+}
+
+
+/**
+ * Write a value as JSON, indented by two spaces per level unless compact.
+ * @return 0
+ */
+static int write_value(jq_run_t *run, FILE *out, const jq_value_t *v,
+                       int depth, int compact) {
+  switch (v->type) {
+    case JQ_NULL: fputs("null", out); break;
+    case JQ_FALSE: fputs("false", out); break;
+    case JQ_TRUE: fputs("true", out); break;
+    case JQ_NUMBER: {
+      double x = v->num;
+      if (v->text) {
+        fputs(v->text, out);
+      } else if (isnan(x)) {
+        fputs("null", out);
+      } else {
+        if (isinf(x)) x = x > 0 ? DBL_MAX : -DBL_MAX;
+        if (x == floor(x) && fabs(x) < 1e17) fprintf(out, "%.0f", x);
+        else fprintf(out, "%.17g", x);
+      }
+      break;
+    }
+    case JQ_STRING:
+      jbox_json_write_string_n(out, v->str, v->len);
+      break;
+    case JQ_ARRAY:
+      if (v->len == 0) {
+        fputs("[]", out);
+        break;
+      }
+      putc('[', out);
+      for (size_t i = 0; i < v->len; i++) {
+        if (i > 0) putc(',', out);
+        if (!compact) write_indent(out, depth + 1);
+        write_value(run, out, v->items[i], depth + 1, compact);
+      }
+      if (!compact) write_indent(out, depth);
+      putc(']', out);
+      break;
+    case JQ_OBJECT:
+      if (v->len == 0) {
+        fputs("{}", out);
+        break;
+      }
+      putc('{', out);
+      for (size_t i = 0; i < v->len; i++) {
+        if (i > 0) putc(',', out);
+        if (!compact) write_indent(out, depth + 1);
+        jbox_json_write_string_n(out, v->members[i].key,
+                                 v->members[i].key_len);
+        fputs(compact ? ":" : ": ", out);
+        write_value(run, out, v->members[i].value, depth + 1, compact);
+      }
+      if (!compact) write_indent(out, depth);
+      putc('}', out);
+      break;
+  }
+  return 0;
+}
+
+
+/**
+ * Print one output of the query.
+ */
+static int print_emit(jq_run_t *run, void *arg, jq_value_t *v) {
+  (void)arg;
+  if (run->raw && v->type == JQ_STRING) {
+    fwrite(v->str, 1, v->len, run->out);
+  } else {
+    write_value(run, run->out, v, 0, run->compact);
+  }
+  putc('\n', run->out);
+  return 0;
+}
+
+
+/**
+ * Build a value from the reader's events; at the top, keep only the
+ * members in keep (if it is given and the value is an object).
+ * @return The value, or NULL if the JSON is malformed or memory ran out.
+ */
+static jq_value_t *read_value(jq_run_t *run, jbox_json_reader_t *r,
+                              jbox_json_event_t ev, const jq_keep_t *keep) {
+  switch (ev) {
+    case JBOX_JSON_NULL: return &jq_null;
+    case JBOX_JSON_TRUE: return &jq_true;
+    case JBOX_JSON_FALSE: return &jq_false;
+    case JBOX_JSON_NUMBER: {
+      jq_value_t *v = new_string(run, r->text, r->text_len);
+      if (!v) return NULL;
+      v->type = JQ_NUMBER;
+      v->text = v->str;
+      v->num = strtod(v->text, NULL);
+      v->str = NULL;
+      v->len = 0;
+      return v;
+    }
+    case JBOX_JSON_STRING:
+      return new_string(run, r->text, r->text_len);
+    case JBOX_JSON_ARRAY_BEGIN: {
+      jq_list_t list = {0};
+      jq_value_t *v = NULL;
+      for (;;) {
+        ev = jbox_json_next(r);
+        if (ev == JBOX_JSON_ARRAY_END) {
+          v = new_array(run, list.items, list.len);
+          break;
+        }
+        jq_value_t *item = read_value(run, r, ev, NULL);
+        if (!item || collect_emit(run, &list, item) != 0) break;
+      }
+      free(list.items);
+      return v;
+    }
+    case JBOX_JSON_OBJECT_BEGIN: {
+      jq_member_t *members = NULL;
+      size_t len = 0, cap = 0;
+      jq_value_t *v = NULL;
+      for (;;) {
+        ev = jbox_json_next(r);
+        if (ev == JBOX_JSON_OBJECT_END) {
+          v = new_value(run, JQ_OBJECT);
+          jq_member_t *copy = arena_alloc(&run->values, (len ? len : 1) *
+                                                        sizeof(jq_member_t));
+          if (!v || !copy) {
+            v = NULL;
+            break;
+          }
+          if (len) memcpy(copy, members, len * sizeof(jq_member_t));
+          v->members = copy;
+          v->len = len;
+          break;
+        }
+        if (ev != JBOX_JSON_KEY) break;
+
+        bool wanted = !keep || keep->all;
+        for (size_t i = 0; !wanted && i < keep->count; i++) {
+          wanted = keep->lens[i] == r->text_len &&
+                   memcmp(keep->names[i], r->text, r->text_len) == 0;
+        }
+        if (!wanted) {
+          if (jbox_json_skip(r, jbox_json_next(r)) != 0) break;
+          continue;
+        }
+
+        jq_value_t *key = new_string(run, r->text, r->text_len);
+        if (!key) break;
+        jq_value_t *value = read_value(run, r, jbox_json_next(r), NULL);
+        if (!value) break;
+        if (len == cap) {
+          cap = cap ? cap * 2 : 8;
+          jq_member_t *grown = realloc(members, cap * sizeof(jq_member_t));
+          if (!grown) break;
+          members = grown;
+        }
+        members[len++] = (jq_member_t){ key->str, key->len, value };
+      }
+      free(members);
+      return v;
+    }
+    default:
+      return NULL;
+  }
+}
+
+
+/** How a query is run over one input stream */
+typedef struct {
+  const jq_node_t *query;
+  const jq_node_t *rest;    /* After a leading .[], or NULL */
+  jq_keep_t keep_query;
+  jq_keep_t keep_rest;
+  int failed;               /* A runtime error was reported */
+} jq_job_t;
+
+
+/**
+ * Evaluate a query on one value cut from the input.
+ * @return 0, or -1 if the value is not valid JSON (reported).
+ */
+static int run_value(jq_run_t *run, jq_job_t *job, const jq_node_t *query,
+                     const jq_keep_t *keep, const char *text, size_t len,
+                     const char *name) {
+  jbox_json_reader_t r;
+  jbox_json_reader_init(&r, text, len);
+  jq_value_t *v = read_value(run, &r, jbox_json_next(&r), keep);
+  int valid = v && jbox_json_next(&r) == JBOX_JSON_DONE;
+  jbox_json_reader_free(&r);
+  if (!valid) {
+    fprintf(stderr, "jq: %s: invalid JSON\n", name);
+    arena_reset(&run->values);
+    return -1;
+  }
+
+  if (eval(run, query, v, print_emit, NULL) != 0) {
+    fprintf(stderr, "jq: error: %s\n", run->error);
+    job->failed = 1;
+  }
+  arena_reset(&run->values);
+  return 0;
+}
+
+
+/**
+ * Skip whitespace in the reader's buffer, reading more as needed.
+ * @return The next byte, -1 at end of input, or -3/-2 on a read
+ *         error/interrupt.
+ */
+static int next_byte(jbox_linereader_t *in) {
+  for (;;) {
+    while (in->start < in->end) {
+      char c = in->buf[in->start];
+      if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+        return (unsigned char)c;
+      }
+      in->start++;
+    }
+    if (in->eof) return -1;
+    ssize_t n = jbox_linereader_fill(in);
+    if (n == -2) return -2;
+    if (n < 0) return -3;
+    if (n == 0) in->eof = 1;
+  }
+}
+
+
+/**
+ * Cut the next value out of the stream and evaluate a query on it.
+ * @return 0, -1 on error (printed), -2 on interrupt.
+ */
+static int next_value(jq_run_t *run, jq_job_t *job, jbox_linereader_t *in,
+                      const jq_node_t *query, const jq_keep_t *keep,
+                      const char *name) {
+  jbox_json_scan_t scan = {0};
+  for (;;) {
+    int got = jbox_json_scan(&scan, in->buf + in->start, in->end - in->start,
+                             in->eof);
+    if (got == 1) break;
+    if (got < 0) {
+      fprintf(stderr, "jq: %s: unexpected end of input\n", name);
+      return -1;
+    }
+    ssize_t n = jbox_linereader_fill(in);
+    if (n == -2) return -2;
+    if (n < 0) {
+      fprintf(stderr, "jq: %s: %s\n", name, strerror(errno));
+      return -1;
+    }
+    if (n == 0) in->eof = 1;
+  }
+
+  int rc = run_value(run, job, query, keep, in->buf + in->start, scan.off,
+                     name);
+  in->start += scan.off;
+  if (jbox_is_interrupted()) return -2;
+  return rc;
+}
+
+
+/**
+ * Run the query over every value of a descriptor. A top-level array is
+ * taken apart element by element when the query starts with .[].
+ * @return 0 on success, -1 on error (printed), -2 on interrupt.
+ */
+static int run_stream(jq_run_t *run, jq_job_t *job, int fd,
+                      const char *name) {
+  jbox_linereader_t in;
+  if (jbox_linereader_init(&in, fd) != 0) {
+    fprintf(stderr, "jq: out of memory\n");
+    return -1;
+  }
+
+  enum { TOP, FIRST, NEXT } where = TOP;
+  int rc = 0;
+  for (;;) {
+    int c = next_byte(&in);
+    if (c == -2 || c == -3) {
+      if (c == -3) fprintf(stderr, "jq: %s: %s\n", name, strerror(errno));
+      rc = c == -2 ? -2 : -1;
+      break;
+    }
+    if (where == TOP) {
+      if (c == -1) break;
+      if (job->rest && c == '[') {
+        in.start++;
+        where = FIRST;
+        continue;
+      }
+      rc = next_value(run, job, &in, job->query, &job->keep_query, name);
+    } else {
+      if (c == ']') {
+        in.start++;
+        where = TOP;
+        continue;
+      }
+      if (where == NEXT) {
+        if (c == ',') {
+          in.start++;
+          c = next_byte(&in);
+        } else {
+          c = -1;
+        }
+      }
+      if (c < 0) {
+        fprintf(stderr, "jq: %s: invalid JSON\n", name);
+        rc = -1;
+        break;
+      }
+      rc = next_value(run, job, &in, job->rest, &job->keep_rest, name);
+      where = NEXT;
+    }
+    if (rc != 0) break;
+  }
+
+  jbox_linereader_free(&in);
+  return rc;
+}
+
+
+// ---------------------------------------------------------------------------
+// Command
+// ---------------------------------------------------------------------------
+
+typedef struct {
+  struct arg_lit *help;
+  struct arg_lit *compact;
+  struct arg_lit *raw;
+  struct arg_lit *null_input;
+  struct arg_str *filter;
+  struct arg_file *files;
+  struct arg_end *end;
+  void *argtable[7];
+} jq_args_t;
+
+
+/**
+ * Build the argument table for the jq command.
+ * @param args Pointer to jq_args_t structure to populate.
+ */
+static void build_jq_argtable(jq_args_t *args) {
+  args->help       = arg_lit0("h", "help", "display this help and exit");
+  args->compact    = arg_lit0("c", "compact-output",
+                              "print each output on one line");
+  args->raw        = arg_lit0("r", "raw-output",
+                              "print strings without quotes");
+  args->null_input = arg_lit0("n", "null-input",
+                              "run the filter once on null; read no input");
+  args->filter     = arg_str1(NULL, NULL, "FILTER", "query to run");
+  args->files      = arg_filen(NULL, NULL, "FILE", 0, 1000,
+                               "files to read (default: standard input)");
+  args->end        = arg_end(20);
+
+  args->argtable[0] = args->help;
+  args->argtable[1] = args->compact;
+  args->argtable[2] = args->raw;
+  args->argtable[3] = args->null_input;
+  args->argtable[4] = args->filter;
+  args->argtable[5] = args->files;
+  args->argtable[6] = args->end;
+}
+
+
+/**
+ * Clean up and free the argument table.
+ * @param args Pointer to jq_args_t structure to clean up.
+ */
+static void cleanup_jq_argtable(jq_args_t *args) {
+  arg_freetable(args->argtable,
+                sizeof(args->argtable) / sizeof(args->argtable[0]));
+}
+
+
+/**
+ * Print usage information for the jq command.
+ * @param out Output stream to write usage information to.
+ */
+static void jq_print_usage(FILE *out) {
+  jq_args_t args;
+  build_jq_argtable(&args);
+  fprintf(out, "Usage: jq");
+  arg_print_syntax(out, args.argtable, "\n");
+  fprintf(out, "Run a jq FILTER over each JSON value of the FILEs.\n\n");
+  fprintf(out, "Options:\n");
+  arg_print_glossary(out, args.argtable, "  %-24s %s\n");
+  fputs("\nSupported: . .name .\"name\" .[n] .[] ? | , // and or "
+        "== != < <= > >=\n"
+        "+ - * / % [...] {...} if-then-elif-else-end, and select map "
+        "length keys has\nnot type empty add tostring tonumber "
+        "startswith endswith contains\nascii_downcase "
+        "ascii_upcase.\n", out);
+  cleanup_jq_argtable(&args);
+}
+
+
+/**
+ * Passes the jq argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void jq_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  jq_args_t args;
+  build_jq_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_jq_argtable(&args);
+}
+
+
+/**
+ * Main entry point for the jq command.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return Exit status (0 on success, 1 on error, 130 on interrupt).
+ */
+static int jq_run(int argc, char **argv) {
+  jq_args_t args;
+  build_jq_argtable(&args);
+
+  jbox_setup_sigint_handler();
+
+  int nerrors = arg_parse(argc, argv, args.argtable);
+
+  if (args.help->count > 0) {
+    jq_print_usage(jbox_stdout());
+    cleanup_jq_argtable(&args);
+    return 0;
+  }
+
+  if (nerrors > 0) {
+    arg_print_errors(stderr, args.end, "jq");
+    fprintf(stderr, "Try 'jq --help' for more information.\n");
+    cleanup_jq_argtable(&args);
+    return 1;
+  }
+
+  jq_arena_t query_arena = {0};
+  jq_job_t job = {0};
+  job.query = parse_query(args.filter->sval[0], &query_arena);
+  if (!job.query) {
+    fprintf(stderr, "Try 'jq --help' for more information.\n");
+    arena_free(&query_arena);
+    cleanup_jq_argtable(&args);
+    return 1;
+  }
+  static const jq_keep_t all = { .all = true };
+  query_reads(job.query, &all, &job.keep_query);
+  job.rest = split_iterate((jq_node_t *)job.query, &query_arena);
+  if (job.rest) query_reads(job.rest, &all, &job.keep_rest);
+
+  jq_run_t run = {
+    .out = jbox_stdout(),
+    .compact = args.compact->count > 0,
+    .raw = args.raw->count > 0,
+  };
+  int file_errors = 0;
+  int rc = 0;
+  if (args.null_input->count > 0) {
+    if (eval(&run, job.query, &jq_null, print_emit, NULL) != 0) {
+      fprintf(stderr, "jq: error: %s\n", run.error);
+      job.failed = 1;
+    }
+  } else {
+    int file_count = args.files->count > 0 ? args.files->count : 1;
+    for (int i = 0; i < file_count && rc == 0; i++) {
+      const char *name = args.files->count > 0 ? args.files->filename[i]
+                                               : "-";
+      int is_stdin = strcmp(name, "-") == 0;
+      int fd = is_stdin ? jbox_stdin_fd() : open(name, O_RDONLY | O_CLOEXEC);
+      if (fd < 0) {
+        fprintf(stderr, "jq: %s: %s\n", name, strerror(errno));
+        file_errors = 1;
+        continue;
+      }
+      struct stat st;
+      if (fstat(fd, &st) == 0 && S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "jq: %s: %s\n", name, strerror(EISDIR));
+        file_errors = 1;
+      } else {
+        int got = run_stream(&run, &job, fd, is_stdin ? "<stdin>" : name);
+        if (got == -1) file_errors = 1;
+        else if (got != 0) rc = got;
+      }
+      if (!is_stdin) close(fd);
+    }
+  }
+  fflush(jbox_stdout());
+
+  arena_free(&run.values);
+  arena_free(&query_arena);
+  cleanup_jq_argtable(&args);
+
+  if (rc == -2) return 130;   /* 128 + SIGINT(2) */
+  return rc == 0 && !file_errors && !job.failed ? 0 : 1;
+}
+
+
+/**
+ * Command specification for jq command.
+ */
+const jshell_cmd_spec_t cmd_jq_spec = {
+  .name = "jq",
+  .summary = "filter JSON and NDJSON with jq queries",
+  .long_help = "Run a FILTER written in a subset of the jq language over "
+               "each JSON value of the FILEs (or standard input): NDJSON "
+               "streams and whole documents alike. Values are evaluated as "
+               "they arrive, a top-level array is taken element by element "
+               "when the FILTER starts with .[], and members the FILTER "
+               "never reads are skipped without being parsed.",
+  .type = CMD_EXTERNAL,
+  .run = jq_run,
+  .print_usage = jq_print_usage,
+  .describe_args = jq_describe_args
+};
+
+
+/**
+ * Registers the jq command with the shell command registry.
+ */
+void jshell_register_jq_command(void) {
+  jshell_register_command(&cmd_jq_spec);
+}
@@ -0,0 +1,10 @@
+#ifndef CMD_JQ_H
+#define CMD_JQ_H
+
+#include "jshell/jshell_cmd_registry.h"
+
+extern const jshell_cmd_spec_t cmd_jq_spec;
+
+void jshell_register_jq_command(void);
+
+#endif
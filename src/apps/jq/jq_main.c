@@ -0,0 +1,17 @@
+/**
+ * @file jq_main.c
+ * @brief Main entry point for standalone jq command.
+ */
+
+#include "cmd_jq.h"
+
+
+/**
+ * Main entry point for standalone jq binary.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return Exit status from jq_run.
+ */
+int main(int argc, char **argv) {
+  return cmd_jq_spec.run(argc, argv);
+}
@@ -1,20 +1,52 @@
 /**
  * @file cmd_less.c
  * @brief Implementation of the less pager for viewing file contents.
+ *
+ * Regular files are mapped rather than read, and lines are drawn straight
+ * from the mapping. Pipes are read into an anonymous reservation of
+ * address space as data arrives, so the screen updates while the producer
+ * is still running and the buffer never moves. A gzip or zstd file is
+ * decompressed into such a reservation by a thread of its own (see
+ * less_decompress.h) and shown as it arrives, like a pipe. Line positions
+ * are found lazily: the pager scans only as far as the screen needs,
+ * keeps scanning in small steps while waiting for a key, and records the
+ * offset of every LESS_INDEX_STRIDE'th line.
+ * The first page of a file of any size is therefore shown at once, and
+ * the index stays a small fraction of the file.
+ *
+ * Searches run on a worker thread that scans the buffer from the top
+ * line to the end and then from the start back to the top line, so the
+ * first hit below the view is found, and jumped to, as early as possible.
+ *
+ * The screen is drawn through jbox_screen, which sends only the cells
+ * that changed, so scrolling a line or updating the status line costs a
+ * few bytes rather than a repaint.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 #include <termios.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <signal.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_linereader.h"
+#include "utils/jbox_regex.h"
+#include "utils/jbox_screen.h"
+#include "less_decompress.h"
 
 
 /**
@@ -23,32 +55,108 @@
 typedef struct {
   struct arg_lit *help;
   struct arg_lit *line_numbers;
+  struct arg_lit *ignore_case;
   struct arg_file *file;
   struct arg_end *end;
-  void *argtable[4];
+  void *argtable[5];
 } less_args_t;
 
 
+/** Lines between two recorded offsets in the line index */
+#define LESS_INDEX_STRIDE 64
+
+/** Bytes scanned for newlines when the screen needs more lines */
+#define LESS_INDEX_STEP (64 * 1024)
+
+/** Bytes scanned per step while indexing in the background */
+#define LESS_INDEX_CHUNK (4 * 1024 * 1024)
+
+/** Address space reserved past the end of a mapped file, for F */
+#define LESS_FILE_RESERVE ((size_t)1 << (sizeof(size_t) > 4 ? 36 : 28))
+
+/** Largest and smallest address space reserved for piped input */
+#define LESS_STREAM_RESERVE ((size_t)1 << (sizeof(size_t) > 4 ? 40 : 30))
+#define LESS_STREAM_MIN ((size_t)1 << 26)
+
+/** Bytes read from a pipe at a time */
+#define LESS_READ_CHUNK (1024 * 1024)
+
+/** Bytes a search scans between progress updates */
+#define LESS_SEARCH_WINDOW (1024 * 1024)
+
+/** Milliseconds between checks while searching or following a file */
+#define LESS_POLL_MS 100
+
+
+/**
+ * State of a background search.
+ *
+ * Hits at or below the line the search started from go in after[], hits
+ * above it in before[]; both are in line order and every line in before[]
+ * precedes every line in after[]. The arrays, counts, scanned and done
+ * are shared with the worker and guarded by lock.
+ */
+typedef struct {
+  pthread_t thread;         /**< Worker thread */
+  pthread_mutex_t lock;     /**< Guards the fields shared with the worker */
+  int active;               /**< Whether a worker has been started */
+  atomic_int cancel;        /**< Set to make the worker stop early */
+  const char *data;         /**< Buffer being searched */
+  size_t size;              /**< Size of data */
+  char pattern[256];        /**< Pattern being searched for */
+  int literal;              /**< Match pattern with memmem() */
+  jbox_regex_t regex;       /**< Compiled pattern unless literal */
+  size_t start_offset;      /**< Offset of the line the search starts at */
+  size_t start_line;        /**< Index of that line */
+  size_t *before;           /**< Hits above start_line */
+  size_t before_count;      /**< Number of hits in before */
+  size_t before_cap;        /**< Allocated entries in before */
+  size_t *after;            /**< Hits from start_line on */
+  size_t after_count;       /**< Number of hits in after */
+  size_t after_cap;         /**< Allocated entries in after */
+  size_t scanned;           /**< Bytes searched so far */
+  int done;                 /**< Whether the worker has finished */
+  int reported;             /**< Whether the result has been shown */
+  int jump_pending;         /**< Jump to the first hit once one is found */
+} less_search_t;
+
+
 /**
  * State structure for the less pager session.
  */
 typedef struct {
-  char **lines;             /**< Array of line strings */
-  size_t line_count;        /**< Total number of lines */
+  char *data;               /**< File mapping or stream buffer */
+  size_t size;              /**< Bytes of data available so far */
+  size_t capacity;          /**< Bytes of address space reserved at data */
+  int file_fd;              /**< Mapped file, kept open for F, or -1 */
+  int source_fd;            /**< Stream still being read, or -1 */
+  less_decompress_t *dec;   /**< Decompressor behind source_fd, or NULL */
+  int input_eof;            /**< Whether no more data is expected */
+  int following;            /**< Whether F mode is on */
+  int line_pending;         /**< A line starts at scan_pos once data comes */
+  size_t *line_offsets;     /**< Offset of every LESS_INDEX_STRIDE'th line */
+  size_t offsets_cap;       /**< Allocated entries in line_offsets */
+  size_t line_count;        /**< Lines found so far */
+  size_t scan_pos;          /**< Offset newline scanning resumes from */
+  int indexed;              /**< Whether all input has been scanned */
+  size_t screen_end;        /**< Offset just past the last line drawn */
   size_t top_line;          /**< Index of the top visible line */
   int rows;                 /**< Terminal rows */
   int cols;                 /**< Terminal columns */
   int show_line_numbers;    /**< Whether to show line numbers */
   int line_num_width;       /**< Width of line number column */
   const char *filename;     /**< Name of file being viewed */
+  int ignore_case;          /**< Whether searches ignore case */
   char search_pattern[256]; /**< Current search pattern */
-  size_t *search_matches;   /**< Array of matching line indices */
-  size_t search_match_count; /**< Number of search matches */
-  size_t current_match;     /**< Index of current match */
+  less_search_t search;     /**< Background search for search_pattern */
+  jbox_screen_t *screen;    /**< Renderer drawing on the terminal */
+  const char *status_msg;   /**< Message shown until the next key */
+  char status_buf[256];     /**< Storage for a formatted status_msg */
 } less_state_t;
 
 
 static struct termios orig_termios;       /**< Original terminal settings */
+static int tty_fd = STDIN_FILENO;         /**< Where keys are read from */
 static volatile sig_atomic_t term_resized = 0;    /**< Window resize flag */
 static volatile sig_atomic_t term_suspended = 0;  /**< Suspend signal flag */
 static volatile sig_atomic_t term_terminated = 0; /**< Terminate signal flag */
@@ -63,13 +171,16 @@ static volatile sig_atomic_t term_interrupted = 0; /**< Interrupt signal flag */
 static void build_less_argtable(less_args_t *args) {
   args->help = arg_lit0("h", "help", "display this help and exit");
   args->line_numbers = arg_lit0("N", NULL, "show line numbers");
+  args->ignore_case = arg_lit0("i", "ignore-case",
+                               "ignore case in searches");
   args->file = arg_file0(NULL, NULL, "FILE", "file to view");
   args->end = arg_end(20);
 
   args->argtable[0] = args->help;
   args->argtable[1] = args->line_numbers;
-  args->argtable[2] = args->file;
-  args->argtable[3] = args->end;
+  args->argtable[2] = args->ignore_case;
+  args->argtable[3] = args->file;
+  args->argtable[4] = args->end;
 }
 
 
@@ -104,7 +215,8 @@ static void less_print_usage(FILE *out) {
   fprintf(out, "  b             Scroll up one page\n");
   fprintf(out, "  g             Go to beginning\n");
   fprintf(out, "  G             Go to end\n");
-  fprintf(out, "  /pattern      Search forward\n");
+  fprintf(out, "  F             Follow: keep showing data as it arrives\n");
+  fprintf(out, "  /pattern      Search forward (extended regex)\n");
   fprintf(out, "  n             Next search match\n");
   fprintf(out, "  N             Previous search match\n");
   fprintf(out, "  q             Quit\n");
@@ -112,6 +224,20 @@ static void less_print_usage(FILE *out) {
 }
 
 
+/**
+ * Passes the less argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void less_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  less_args_t args;
+  build_less_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_less_argtable(&args);
+}
+
+
 /**
  * Signal handler for SIGWINCH (window resize).
  */
@@ -161,7 +287,7 @@ static void handle_sigint(int sig) {
  * Restores original terminal settings.
  */
 static void disable_raw_mode(void) {
-  tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios);
+  tcsetattr(tty_fd, TCSAFLUSH, &orig_termios);
 }
 
 
@@ -171,7 +297,7 @@ static void disable_raw_mode(void) {
  * @return 0 on success, -1 on error.
  */
 static int enable_raw_mode(void) {
-  if (tcgetattr(STDIN_FILENO, &orig_termios) == -1) {
+  if (tcgetattr(tty_fd, &orig_termios) == -1) {
     return -1;
   }
 
@@ -182,7 +308,7 @@ static int enable_raw_mode(void) {
   raw.c_cc[VMIN] = 1;
   raw.c_cc[VTIME] = 0;
 
-  if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) {
+  if (tcsetattr(tty_fd, TCSAFLUSH, &raw) == -1) {
     return -1;
   }
 
@@ -209,143 +335,143 @@ static void get_terminal_size(int *rows, int *cols) {
 
 
 /**
- * Splits content string into an array of lines.
+ * Records the start of the next line in the index.
  *
- * @param content    The content string to split.
- * @param line_count Pointer to store the number of lines.
- * @return Array of line strings, or NULL on error. Caller must free.
+ * @param state  Pager state.
+ * @param offset Offset of the line's first byte.
+ * @return 0 on success, -1 if out of memory.
  */
-static char **split_lines(const char *content, size_t *line_count) {
-  size_t capacity = 256;
-  char **lines = malloc(capacity * sizeof(char *));
-  if (!lines) return NULL;
-
-  *line_count = 0;
-  const char *start = content;
-  const char *end;
-
-  while ((end = strchr(start, '\n')) != NULL) {
-    if (*line_count >= capacity) {
-      capacity *= 2;
-      char **new_lines = realloc(lines, capacity * sizeof(char *));
-      if (!new_lines) {
-        for (size_t i = 0; i < *line_count; i++) free(lines[i]);
-        free(lines);
-        return NULL;
-      }
-      lines = new_lines;
-    }
-
-    size_t len = (size_t)(end - start);
-    lines[*line_count] = malloc(len + 1);
-    if (!lines[*line_count]) {
-      for (size_t i = 0; i < *line_count; i++) free(lines[i]);
-      free(lines);
-      return NULL;
-    }
-    memcpy(lines[*line_count], start, len);
-    lines[*line_count][len] = '\0';
-    (*line_count)++;
-    start = end + 1;
-  }
-
-  if (*start != '\0') {
-    if (*line_count >= capacity) {
-      capacity++;
-      char **new_lines = realloc(lines, capacity * sizeof(char *));
-      if (!new_lines) {
-        for (size_t i = 0; i < *line_count; i++) free(lines[i]);
-        free(lines);
-        return NULL;
-      }
-      lines = new_lines;
+static int add_line(less_state_t *state, size_t offset) {
+  if (state->line_count % LESS_INDEX_STRIDE == 0) {
+    size_t slot = state->line_count / LESS_INDEX_STRIDE;
+    if (slot >= state->offsets_cap) {
+      size_t cap = state->offsets_cap ? state->offsets_cap * 2 : 1024;
+      size_t *offsets = realloc(state->line_offsets, cap * sizeof(*offsets));
+      if (!offsets) return -1;
+      state->line_offsets = offsets;
+      state->offsets_cap = cap;
     }
-    lines[*line_count] = strdup(start);
-    if (!lines[*line_count]) {
-      for (size_t i = 0; i < *line_count; i++) free(lines[i]);
-      free(lines);
-      return NULL;
-    }
-    (*line_count)++;
+    state->line_offsets[slot] = offset;
   }
-
-  return lines;
+  state->line_count++;
+  return 0;
 }
 
 
 /**
- * Frees an array of lines allocated by split_lines.
+ * Scans up to limit more bytes of the data for line starts.
  *
- * @param lines      Array of line strings to free.
- * @param line_count Number of lines in the array.
+ * A newline at the very end of the data only opens a line once more
+ * data arrives, so a stream's last line is not counted before it exists.
+ *
+ * @param state Pager state.
+ * @param limit Maximum number of bytes to scan.
  */
-static void free_lines(char **lines, size_t line_count) {
-  for (size_t i = 0; i < line_count; i++) {
-    free(lines[i]);
+static void index_step(less_state_t *state, size_t limit) {
+  const char *data = state->data;
+  size_t pos = state->scan_pos;
+  size_t end = state->size - pos > limit ? pos + limit : state->size;
+
+  if (state->line_pending && pos < state->size) {
+    if (add_line(state, pos) != 0) goto out_of_memory;
+    state->line_pending = 0;
   }
-  free(lines);
-}
-
 
-/**
- * Counts the number of decimal digits in a number.
- *
- * @param n The number to count digits of.
- * @return Number of digits.
- */
-static int count_digits(size_t n) {
-  int count = 0;
-  do {
-    count++;
-    n /= 10;
-  } while (n > 0);
-  return count;
-}
+  while (pos < end) {
+    /* Only every LESS_INDEX_STRIDE'th line start is recorded; the lines
+     * before it are only counted */
+    size_t skip = (LESS_INDEX_STRIDE - state->line_count % LESS_INDEX_STRIDE)
+                  % LESS_INDEX_STRIDE + 1;
+    size_t nl = jbox_linereader_nth(data + pos, end - pos, skip);
+    if (nl == end - pos) {
+      size_t n = jbox_linereader_count(data + pos, end - pos);
+      if (n > 0 && end == state->size && data[end - 1] == '\n') {
+        n--;
+        state->line_pending = 1;
+      }
+      state->line_count += n;
+      pos = end;
+      break;
+    }
+    state->line_count += skip - 1;
+    pos += nl + 1;
+    if (pos == state->size) {
+      state->line_pending = 1;
+    } else if (add_line(state, pos) != 0) {
+      goto out_of_memory;
+    }
+  }
 
+  state->scan_pos = pos;
+  state->indexed = pos >= state->size && state->input_eof;
+  return;
 
-/**
- * Clears the terminal screen and moves cursor to home position.
- */
-static void clear_screen(void) {
-  write(STDOUT_FILENO, "\x1b[2J", 4);
-  write(STDOUT_FILENO, "\x1b[H", 3);
+out_of_memory:
+  /* Show the lines found so far as the whole input */
+  state->scan_pos = state->size;
+  state->line_pending = 0;
+  state->indexed = 1;
 }
 
 
 /**
- * Moves the terminal cursor to a specific position.
+ * Indexes the data until at least count lines are known or it runs out.
  *
- * @param row Row number (1-based).
- * @param col Column number (1-based).
+ * @param state Pager state.
+ * @param count Number of lines wanted.
  */
-static void move_cursor(int row, int col) {
-  char buf[32];
-  int len = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", row, col);
-  write(STDOUT_FILENO, buf, (size_t)len);
+static void ensure_lines(less_state_t *state, size_t count) {
+  while (state->scan_pos < state->size && state->line_count < count) {
+    index_step(state, LESS_INDEX_STEP);
+  }
 }
 
 
 /**
- * Clears from cursor to end of current line.
+ * Finds where a known line starts.
+ *
+ * @param state    Pager state.
+ * @param line_idx Index of the line, less than state->line_count.
+ * @return Offset of the line's first byte.
  */
-static void clear_line(void) {
-  write(STDOUT_FILENO, "\x1b[K", 3);
+static size_t line_offset(less_state_t *state, size_t line_idx) {
+  size_t offset = state->line_offsets[line_idx / LESS_INDEX_STRIDE];
+  size_t skip = line_idx % LESS_INDEX_STRIDE;
+  if (skip > 0) {
+    offset += jbox_linereader_nth(state->data + offset,
+                                  state->size - offset, skip) + 1;
+  }
+  return offset;
 }
 
 
 /**
- * Enables reverse video mode for status line display.
+ * Finds where the line starting at an offset ends.
+ *
+ * @param state  Pager state.
+ * @param offset Offset of the line's first byte.
+ * @return Offset of its newline, or the file size for a last line
+ *         without one.
  */
-static void set_reverse_video(void) {
-  write(STDOUT_FILENO, "\x1b[7m", 4);
+static size_t line_end(less_state_t *state, size_t offset) {
+  const char *nl = memchr(state->data + offset, '\n', state->size - offset);
+  return nl ? (size_t)(nl - state->data) : state->size;
 }
 
 
 /**
- * Resets terminal video attributes to normal.
+ * Counts the number of decimal digits in a number.
+ *
+ * @param n The number to count digits of.
+ * @return Number of digits.
  */
-static void reset_video(void) {
-  write(STDOUT_FILENO, "\x1b[0m", 4);
+static int count_digits(size_t n) {
+  int count = 0;
+  do {
+    count++;
+    n /= 10;
+  } while (n > 0);
+  return count;
 }
 
 
@@ -381,92 +507,146 @@ static void less_suspend(void) {
  *
  * @param state      Pager state.
  * @param line_idx   Index of the line to draw.
- * @param screen_row Screen row to draw on (1-based).
+ * @param line       Start of the line, or NULL past the end of the file.
+ * @param line_len   Length of the line without its newline.
+ * @param screen_row Screen row to draw on (0-based).
  */
-static void draw_line(less_state_t *state, size_t line_idx, int screen_row) {
-  move_cursor(screen_row, 1);
-  clear_line();
+static void draw_line(less_state_t *state, size_t line_idx, const char *line,
+                      size_t line_len, int screen_row) {
+  jbox_screen_clear_row(state->screen, screen_row);
 
-  if (line_idx >= state->line_count) {
-    write(STDOUT_FILENO, "~", 1);
+  if (!line) {
+    jbox_screen_put(state->screen, screen_row, 0, "~", 1, 0);
     return;
   }
 
-  char buf[16];
-  int prefix_len = 0;
-
+  int col = 0;
   if (state->show_line_numbers) {
+    char buf[32];
     int len = snprintf(buf, sizeof(buf), "%*zu ", state->line_num_width,
                        line_idx + 1);
-    write(STDOUT_FILENO, buf, (size_t)len);
-    prefix_len = len;
-  }
-
-  const char *line = state->lines[line_idx];
-  int max_chars = state->cols - prefix_len;
-  if (max_chars < 0) max_chars = 0;
-
-  size_t line_len = strlen(line);
-  if ((int)line_len > max_chars) {
-    write(STDOUT_FILENO, line, (size_t)max_chars);
-  } else {
-    write(STDOUT_FILENO, line, line_len);
+    col = jbox_screen_put(state->screen, screen_row, 0, buf, (size_t)len, 0);
   }
+  jbox_screen_put(state->screen, screen_row, col, line, line_len, 0);
 }
 
 
 /**
- * Draws the status line at the bottom of the screen.
+ * Draws the status line at the bottom of the screen and sends the frame
+ * to the terminal.
+ *
+ * Until the whole file has been indexed the line total is shown as a
+ * lower bound and the percentage is by bytes instead of lines.
  *
  * @param state Pager state.
  * @param msg   Optional message to display, or NULL for default status.
  */
 static void draw_status_line(less_state_t *state, const char *msg) {
-  move_cursor(state->rows, 1);
-  set_reverse_video();
-  clear_line();
+  char buf[256];
+  int len;
 
+  if (!msg) msg = state->status_msg;
   if (msg) {
-    write(STDOUT_FILENO, msg, strlen(msg));
+    len = snprintf(buf, sizeof(buf), "%s", msg);
   } else {
-    char buf[256];
     size_t end_line = state->top_line + (size_t)(state->rows - 1);
     if (end_line > state->line_count) end_line = state->line_count;
 
     int percent;
-    if (state->line_count <= (size_t)(state->rows - 1)) {
+    if (!state->indexed) {
+      percent = state->size == 0 ? 0 :
+                (int)(100.0 * (double)state->screen_end /
+                      (double)state->size);
+    } else if (state->line_count <= (size_t)(state->rows - 1)) {
       percent = 100;
     } else {
       percent = (int)(100 * end_line / state->line_count);
     }
 
-    int len = snprintf(buf, sizeof(buf), " %s lines %zu-%zu/%zu (%d%%)",
-                       state->filename,
-                       state->top_line + 1,
-                       end_line,
-                       state->line_count,
-                       percent);
-    write(STDOUT_FILENO, buf, (size_t)len);
-  }
+    len = snprintf(buf, sizeof(buf), " %s lines %zu-%zu/%zu%s (%d%%)",
+                   state->filename,
+                   state->top_line + 1,
+                   end_line,
+                   state->line_count,
+                   state->indexed ? "" : "+",
+                   percent);
+
+    if (state->dec && len < (int)sizeof(buf)) {
+      len += snprintf(buf + len, sizeof(buf) - (size_t)len,
+                      "  [decompressing %d%%]",
+                      less_decompress_progress(state->dec));
+    }
 
-  reset_video();
+    less_search_t *search = &state->search;
+    if (search->active && len < (int)sizeof(buf)) {
+      pthread_mutex_lock(&search->lock);
+      if (!search->done) {
+        int searched = (int)(100.0 * (double)search->scanned /
+                             (double)search->size);
+        len += snprintf(buf + len, sizeof(buf) - (size_t)len,
+                        "  [searching %d%%]", searched);
+      }
+      pthread_mutex_unlock(&search->lock);
+    }
+  }
+  if (len >= (int)sizeof(buf)) len = (int)sizeof(buf) - 1;
+
+  int row = state->rows - 1;
+  jbox_screen_clear_row(state->screen, row);
+  int col = jbox_screen_put(state->screen, row, 0, buf, (size_t)len,
+                            JBOX_SCREEN_REVERSE);
+  jbox_screen_set_cursor(state->screen, row, col);
+  jbox_screen_flush(state->screen);
 }
 
 
 /**
- * Redraws the entire screen contents.
+ * Redraws the entire screen contents. Only the cells that differ from
+ * what the terminal already shows are sent.
  *
  * @param state Pager state.
  */
 static void draw_screen(less_state_t *state) {
-  for (int row = 1; row < state->rows; row++) {
-    size_t line_idx = state->top_line + (size_t)(row - 1);
-    draw_line(state, line_idx, row);
+  size_t rows = (size_t)(state->rows - 1);
+  ensure_lines(state, state->top_line + rows);
+
+  state->line_num_width = count_digits(state->line_count);
+  if (state->line_num_width < 4) state->line_num_width = 4;
+
+  size_t offset = state->top_line < state->line_count ?
+                  line_offset(state, state->top_line) : state->size;
+  for (size_t row = 0; row < rows; row++) {
+    size_t line_idx = state->top_line + row;
+    if (line_idx >= state->line_count) {
+      draw_line(state, line_idx, NULL, 0, (int)row);
+      continue;
+    }
+    size_t end = line_end(state, offset);
+    draw_line(state, line_idx, state->data + offset, end - offset, (int)row);
+    offset = end < state->size ? end + 1 : end;
   }
+  state->screen_end = offset;
   draw_status_line(state, NULL);
 }
 
 
+/**
+ * Picks up a new terminal size. The next frame repaints everything.
+ *
+ * @param state Pager state.
+ */
+static void resize_screen(less_state_t *state) {
+  int rows, cols;
+  get_terminal_size(&rows, &cols);
+  if (jbox_screen_resize(state->screen, rows, cols) == 0) {
+    state->rows = rows;
+    state->cols = cols;
+  } else {
+    jbox_screen_invalidate(state->screen);
+  }
+}
+
+
 /**
  * Scrolls the view down by a number of lines.
  *
@@ -474,6 +654,8 @@ static void draw_screen(less_state_t *state) {
  * @param lines Number of lines to scroll.
  */
 static void scroll_down(less_state_t *state, size_t lines) {
+  ensure_lines(state, state->top_line + lines + (size_t)(state->rows - 1));
+
   size_t max_top = 0;
   if (state->line_count > (size_t)(state->rows - 1)) {
     max_top = state->line_count - (size_t)(state->rows - 1);
@@ -518,6 +700,14 @@ static void goto_beginning(less_state_t *state) {
  * @param state Pager state.
  */
 static void goto_end(less_state_t *state) {
+  if (state->size - state->scan_pos > LESS_INDEX_CHUNK) {
+    draw_status_line(state, " Counting lines...");
+  }
+  while (state->scan_pos < state->size && !term_interrupted &&
+         !term_terminated) {
+    index_step(state, LESS_INDEX_CHUNK);
+  }
+
   if (state->line_count > (size_t)(state->rows - 1)) {
     state->top_line = state->line_count - (size_t)(state->rows - 1);
   } else {
@@ -527,76 +717,397 @@ static void goto_end(less_state_t *state) {
 
 
 /**
- * Searches for the current pattern and populates match list.
+ * Finds the next hit of the pattern in a window of the buffer.
+ *
+ * @param search Search state.
+ * @param window Offset of the window, which starts at a line.
+ * @param from   Offset to search from, at or after window.
+ * @param end    Offset the window ends at.
+ * @param hit    Pointer to store the offset of the hit.
+ * @return 1 if there is a hit, 0 otherwise.
+ */
+static int search_next_hit(less_search_t *search, size_t window, size_t from,
+                           size_t end, size_t *hit) {
+  if (search->literal) {
+    const char *found = memmem(search->data + from, end - from,
+                               search->pattern, strlen(search->pattern));
+    if (!found) return 0;
+    *hit = (size_t)(found - search->data);
+    return 1;
+  }
+
+  regmatch_t match;
+  if (jbox_regex_exec_at(&search->regex, search->data + window, end - window,
+                         from - window, &match) != 0) {
+    return 0;
+  }
+  *hit = window + (size_t)match.rm_so;
+  return 1;
+}
+
+
+/**
+ * Appends hits to one of the search's result arrays.
  *
- * @param state Pager state containing search_pattern to search for.
+ * @param search Search state.
+ * @param after  Whether the hits go in after[] rather than before[].
+ * @param lines  Line indices to append.
+ * @param count  Number of lines.
+ * @param scanned Bytes searched since the last call.
+ * @return 0 on success, -1 if out of memory.
  */
-static void search_pattern(less_state_t *state) {
-  free(state->search_matches);
-  state->search_matches = NULL;
-  state->search_match_count = 0;
-  state->current_match = 0;
-
-  if (state->search_pattern[0] == '\0') return;
-
-  size_t capacity = 64;
-  state->search_matches = malloc(capacity * sizeof(size_t));
-  if (!state->search_matches) return;
-
-  for (size_t i = 0; i < state->line_count; i++) {
-    if (strstr(state->lines[i], state->search_pattern)) {
-      if (state->search_match_count >= capacity) {
-        capacity *= 2;
-        size_t *new_matches = realloc(state->search_matches,
-                                      capacity * sizeof(size_t));
-        if (!new_matches) break;
-        state->search_matches = new_matches;
+static int search_flush(less_search_t *search, int after, const size_t *lines,
+                        size_t count, size_t scanned) {
+  size_t **array = after ? &search->after : &search->before;
+  size_t *used = after ? &search->after_count : &search->before_count;
+  size_t *cap = after ? &search->after_cap : &search->before_cap;
+  int result = 0;
+
+  pthread_mutex_lock(&search->lock);
+  if (*used + count > *cap) {
+    size_t new_cap = *cap ? *cap : 64;
+    while (new_cap < *used + count) new_cap *= 2;
+    size_t *grown = realloc(*array, new_cap * sizeof(*grown));
+    if (grown) {
+      *array = grown;
+      *cap = new_cap;
+    } else {
+      result = -1;
+    }
+  }
+  if (result == 0) {
+    memcpy(*array + *used, lines, count * sizeof(*lines));
+    *used += count;
+  }
+  search->scanned += scanned;
+  pthread_mutex_unlock(&search->lock);
+  return result;
+}
+
+
+/**
+ * Searches one range of the buffer, a window at a time.
+ *
+ * @param search Search state.
+ * @param offset Offset of the first line of the range.
+ * @param line   Index of that line.
+ * @param end    Offset the range ends at, at a line boundary.
+ * @param after  Whether hits go in after[] rather than before[].
+ * @return 0 when the range is done, -1 if cancelled or out of memory.
+ */
+static int search_range(less_search_t *search, size_t offset, size_t line,
+                        size_t end, int after) {
+  const char *data = search->data;
+  size_t hits[1024];
+  size_t nhits = 0;
+
+  while (offset < end) {
+    if (atomic_load(&search->cancel)) return -1;
+
+    size_t window_end = end - offset > LESS_SEARCH_WINDOW ?
+                        offset + LESS_SEARCH_WINDOW : end;
+    if (window_end < end) {
+      const char *nl = memchr(data + window_end, '\n', end - window_end);
+      window_end = nl ? (size_t)(nl - data) + 1 : end;
+    }
+
+    size_t line_start = offset;
+    size_t from = offset;
+    size_t hit;
+    while (from < window_end &&
+           search_next_hit(search, offset, from, window_end, &hit)) {
+      /* An empty match at the window's end belongs to the next line,
+       * unless it is the unterminated last line of the file */
+      if (hit == window_end &&
+          (hit < search->size || data[hit - 1] == '\n')) {
+        break;
       }
-      state->search_matches[state->search_match_count++] = i;
+
+      const char *nl;
+      while ((nl = memchr(data + line_start, '\n', hit - line_start))) {
+        line_start = (size_t)(nl - data) + 1;
+        line++;
+      }
+
+      hits[nhits++] = line;
+      if (nhits == sizeof(hits) / sizeof(hits[0])) {
+        if (search_flush(search, after, hits, nhits, 0) != 0) return -1;
+        nhits = 0;
+      }
+
+      nl = memchr(data + hit, '\n', window_end - hit);
+      if (!nl) {
+        from = window_end;
+        break;
+      }
+      line_start = from = (size_t)(nl - data) + 1;
+      line++;
     }
+
+    const char *nl;
+    while ((nl = memchr(data + line_start, '\n', window_end - line_start))) {
+      line_start = (size_t)(nl - data) + 1;
+      line++;
+    }
+
+    if (search_flush(search, after, hits, nhits, window_end - offset) != 0) {
+      return -1;
+    }
+    nhits = 0;
+    offset = window_end;
   }
+  return 0;
 }
 
 
 /**
- * Jumps to the next search match.
+ * Worker thread: searches from the start line to the end of the buffer,
+ * then from the beginning up to the start line.
+ *
+ * @param arg Search state.
+ * @return NULL.
+ */
+static void *search_worker(void *arg) {
+  less_search_t *search = arg;
+
+  if (search_range(search, search->start_offset, search->start_line,
+                   search->size, 1) == 0) {
+    search_range(search, 0, 0, search->start_offset, 0);
+  }
+
+  pthread_mutex_lock(&search->lock);
+  search->done = 1;
+  pthread_mutex_unlock(&search->lock);
+  return NULL;
+}
+
+
+/**
+ * Stops any running search and discards its results.
  *
  * @param state Pager state.
  */
-static void goto_next_match(less_state_t *state) {
-  if (state->search_match_count == 0) return;
+static void search_stop(less_state_t *state) {
+  less_search_t *search = &state->search;
+  if (!search->active) return;
+
+  atomic_store(&search->cancel, 1);
+  pthread_join(search->thread, NULL);
+  pthread_mutex_destroy(&search->lock);
+  if (!search->literal) jbox_regex_free(&search->regex);
+  free(search->before);
+  free(search->after);
+  memset(search, 0, sizeof(*search));
+}
+
 
-  for (size_t i = state->current_match; i < state->search_match_count; i++) {
-    if (state->search_matches[i] > state->top_line) {
-      state->current_match = i;
-      state->top_line = state->search_matches[i];
+/**
+ * Starts a background search for state->search_pattern.
+ *
+ * Patterns are POSIX extended regular expressions; one with no special
+ * characters is matched with memmem() instead. Results come in through
+ * search_poll(), which jumps to the first hit at or below the top line.
+ *
+ * @param state Pager state.
+ */
+static void search_start(less_state_t *state) {
+  less_search_t *search = &state->search;
+  search_stop(state);
+  if (state->search_pattern[0] == '\0' || state->size == 0) return;
+
+  memcpy(search->pattern, state->search_pattern, sizeof(search->pattern));
+  search->literal = !state->ignore_case &&
+                    strpbrk(search->pattern, ".[]()*+?{}|^$\\") == NULL;
+  if (!search->literal) {
+    int cflags = REG_EXTENDED | REG_NEWLINE;
+    if (state->ignore_case) cflags |= REG_ICASE;
+    int err = jbox_regex_compile(&search->regex, search->pattern, cflags);
+    if (err != 0) {
+      char msg[200];
+      jbox_regex_error(err, &search->regex, msg, sizeof(msg));
+      snprintf(state->status_buf, sizeof(state->status_buf),
+               " Invalid pattern: %s", msg);
+      state->status_msg = state->status_buf;
+      memset(search, 0, sizeof(*search));
       return;
     }
   }
 
-  state->current_match = 0;
-  state->top_line = state->search_matches[0];
+  search->data = state->data;
+  search->size = state->size;
+  ensure_lines(state, state->top_line + 1);
+  if (state->top_line < state->line_count) {
+    search->start_line = state->top_line;
+    search->start_offset = line_offset(state, state->top_line);
+  }
+  search->jump_pending = 1;
+  pthread_mutex_init(&search->lock, NULL);
+  atomic_init(&search->cancel, 0);
+
+  if (pthread_create(&search->thread, NULL, search_worker, search) != 0) {
+    pthread_mutex_destroy(&search->lock);
+    if (!search->literal) jbox_regex_free(&search->regex);
+    memset(search, 0, sizeof(*search));
+    state->status_msg = " Cannot start search";
+    return;
+  }
+  search->active = 1;
 }
 
 
 /**
- * Jumps to the previous search match.
+ * Returns the i'th hit in line order. Caller holds the search lock.
+ */
+static size_t search_hit(const less_search_t *search, size_t i) {
+  return i < search->before_count ? search->before[i] :
+         search->after[i - search->before_count];
+}
+
+
+/**
+ * Finds the hit nearest a line in one direction. Caller holds the
+ * search lock.
+ *
+ * Hits that are not found yet are not considered; the search only wraps
+ * around once it is done.
+ *
+ * @param search    Search state.
+ * @param line      Line to search from.
+ * @param forward   Look for a later line rather than an earlier one.
+ * @param inclusive Whether line itself counts.
+ * @param found     Pointer to store the hit's line.
+ * @return 1 if a hit was found, 0 otherwise.
+ */
+static int search_find(const less_search_t *search, size_t line, int forward,
+                       int inclusive, size_t *found) {
+  size_t count = search->before_count + search->after_count;
+  if (count == 0) return 0;
+
+  /* First hit after line (or at it, when inclusive) */
+  size_t lo = 0, hi = count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    size_t hit = search_hit(search, mid);
+    if (hit > line || (inclusive && hit == line)) hi = mid;
+    else lo = mid + 1;
+  }
+
+  if (forward) {
+    if (lo < count) {
+      *found = search_hit(search, lo);
+      return 1;
+    }
+    if (!search->done) return 0;
+    *found = search_hit(search, 0);
+    return 1;
+  }
+
+  /* Last hit before line */
+  while (lo > 0 && search_hit(search, lo - 1) >= line) lo--;
+  if (lo > 0) {
+    *found = search_hit(search, lo - 1);
+    return 1;
+  }
+  if (!search->done) return 0;
+  *found = search_hit(search, count - 1);
+  return 1;
+}
+
+
+/**
+ * Picks up progress from the search worker: performs a pending jump once
+ * a hit is found and reports a search that found nothing.
  *
  * @param state Pager state.
+ * @return 1 while the search is still running, 0 otherwise.
  */
-static void goto_prev_match(less_state_t *state) {
-  if (state->search_match_count == 0) return;
+static int search_poll(less_state_t *state) {
+  less_search_t *search = &state->search;
+  if (!search->active) return 0;
+
+  int redraw = 0;
+  pthread_mutex_lock(&search->lock);
+  int done = search->done;
+  size_t line;
+  if (search->jump_pending &&
+      search_find(search, search->start_line, 1, 1, &line)) {
+    search->jump_pending = 0;
+    state->top_line = line;
+    redraw = 1;
+  }
+  if (done && !search->reported) {
+    search->reported = 1;
+    search->jump_pending = 0;
+    if (search->before_count + search->after_count == 0 &&
+        !atomic_load(&search->cancel)) {
+      state->status_msg = " Pattern not found";
+    }
+    redraw = 1;
+  }
+  pthread_mutex_unlock(&search->lock);
 
-  for (size_t i = state->current_match; i > 0; i--) {
-    if (state->search_matches[i - 1] < state->top_line) {
-      state->current_match = i - 1;
-      state->top_line = state->search_matches[i - 1];
-      return;
+  if (redraw) {
+    ensure_lines(state, state->top_line + 1);
+    if (state->top_line >= state->line_count && state->line_count > 0) {
+      state->top_line = state->line_count - 1;
     }
+    draw_screen(state);
+  } else if (!done) {
+    draw_status_line(state, NULL);
   }
+  return !done;
+}
+
 
-  state->current_match = state->search_match_count - 1;
-  state->top_line = state->search_matches[state->current_match];
+/**
+ * Jumps to the next search match.
+ *
+ * @param state Pager state.
+ */
+static void goto_next_match(less_state_t *state) {
+  less_search_t *search = &state->search;
+  if (!search->active) return;
+
+  size_t line;
+  pthread_mutex_lock(&search->lock);
+  int found = search_find(search, state->top_line, 1, 0, &line);
+  pthread_mutex_unlock(&search->lock);
+  if (found) state->top_line = line;
+}
+
+
+/**
+ * Jumps to the previous search match.
+ *
+ * @param state Pager state.
+ */
+static void goto_prev_match(less_state_t *state) {
+  less_search_t *search = &state->search;
+  if (!search->active) return;
+
+  size_t line;
+  pthread_mutex_lock(&search->lock);
+  int found = search_find(search, state->top_line, 0, 0, &line);
+  pthread_mutex_unlock(&search->lock);
+  if (found) state->top_line = line;
+}
+
+
+/**
+ * Draws the search prompt with the pattern typed so far on the status
+ * line, leaving the cursor after it.
+ *
+ * @param state Pager state.
+ * @param len   Length of the pattern typed so far.
+ */
+static void draw_search_prompt(less_state_t *state, size_t len) {
+  int row = state->rows - 1;
+  jbox_screen_clear_row(state->screen, row);
+  int col = jbox_screen_put(state->screen, row, 0, "/", 1,
+                            JBOX_SCREEN_REVERSE);
+  col = jbox_screen_put(state->screen, row, col, state->search_pattern, len, 0);
+  jbox_screen_set_cursor(state->screen, row, col);
+  jbox_screen_flush(state->screen);
 }
 
 
@@ -607,11 +1118,9 @@ static void goto_prev_match(less_state_t *state) {
  * @return 1 if search was performed, 0 if cancelled, -1 if interrupted.
  */
 static int read_search_input(less_state_t *state) {
-  draw_status_line(state, "/");
-  move_cursor(state->rows, 2);
-
   size_t pos = 0;
   state->search_pattern[0] = '\0';
+  draw_search_prompt(state, pos);
 
   while (1) {
     /* Check for signal interruption */
@@ -621,7 +1130,7 @@ static int read_search_input(less_state_t *state) {
     }
 
     char c;
-    ssize_t n = read(STDIN_FILENO, &c, 1);
+    ssize_t n = read(tty_fd, &c, 1);
     if (n != 1) {
       /* read() interrupted or error */
       if (term_interrupted || term_terminated || term_suspended) {
@@ -632,17 +1141,8 @@ static int read_search_input(less_state_t *state) {
     }
 
     if (c == '\n' || c == '\r') {
-      search_pattern(state);
-      if (state->search_match_count > 0) {
-        state->current_match = 0;
-        for (size_t i = 0; i < state->search_match_count; i++) {
-          if (state->search_matches[i] >= state->top_line) {
-            state->current_match = i;
-            state->top_line = state->search_matches[i];
-            break;
-          }
-        }
-      }
+      search_start(state);
+      search_poll(state);
       return 1;
     } else if (c == 27) {
       state->search_pattern[0] = '\0';
@@ -651,14 +1151,12 @@ static int read_search_input(less_state_t *state) {
       if (pos > 0) {
         pos--;
         state->search_pattern[pos] = '\0';
-        move_cursor(state->rows, 2);
-        clear_line();
-        write(STDOUT_FILENO, state->search_pattern, pos);
+        draw_search_prompt(state, pos);
       }
     } else if (isprint((unsigned char)c) && pos < sizeof(state->search_pattern) - 1) {
       state->search_pattern[pos++] = c;
       state->search_pattern[pos] = '\0';
-      write(STDOUT_FILENO, &c, 1);
+      draw_search_prompt(state, pos);
     }
   }
 
@@ -673,7 +1171,7 @@ static int read_search_input(less_state_t *state) {
  */
 static int read_key(void) {
   char c;
-  ssize_t n = read(STDIN_FILENO, &c, 1);
+  ssize_t n = read(tty_fd, &c, 1);
 
   /* Check for signal interruption */
   if (n != 1) {
@@ -685,8 +1183,8 @@ static int read_key(void) {
 
   if (c == 27) {
     char seq[3];
-    if (read(STDIN_FILENO, &seq[0], 1) != 1) return 27;
-    if (read(STDIN_FILENO, &seq[1], 1) != 1) return 27;
+    if (read(tty_fd, &seq[0], 1) != 1) return 27;
+    if (read(tty_fd, &seq[1], 1) != 1) return 27;
 
     if (seq[0] == '[') {
       switch (seq[1]) {
@@ -695,10 +1193,10 @@ static int read_key(void) {
         case 'C': return 1002;
         case 'D': return 1003;
         case '5':
-          read(STDIN_FILENO, &seq[2], 1);
+          read(tty_fd, &seq[2], 1);
           return 1004;
         case '6':
-          read(STDIN_FILENO, &seq[2], 1);
+          read(tty_fd, &seq[2], 1);
           return 1005;
       }
     }
@@ -710,75 +1208,238 @@ static int read_key(void) {
 
 
 /**
- * Reads all content from stdin into a dynamically allocated buffer.
+ * Sets up the data buffer for an input descriptor.
+ *
+ * Regular files are mapped with address space to spare beyond their end,
+ * so nothing is read until it is drawn, searched or indexed, and data
+ * appended later shows through the same mapping for F. Anything else,
+ * such as a pipe, gets an anonymous reservation that read_more() fills
+ * as data arrives. Its pages are only committed as they are written, so
+ * memory grows with the input a page at a time and nothing is copied.
+ * A compressed regular file gets such a reservation too, which its
+ * decompressor fills instead.
  *
- * @return Newly allocated content string, or NULL on error.
+ * @param state Pager state to fill in.
+ * @param fd    Descriptor to view; owned by the state afterwards.
+ * @return 0 on success, -1 on error (errno set).
  */
-static char *read_stdin_content(void) {
-  size_t capacity = 4096;
-  size_t size = 0;
-  char *content = malloc(capacity);
-  if (!content) return NULL;
-
-  char buf[1024];
-  ssize_t n;
-
-  while ((n = read(STDIN_FILENO, buf, sizeof(buf))) > 0) {
-    if (size + (size_t)n >= capacity) {
-      capacity *= 2;
-      char *new_content = realloc(content, capacity);
-      if (!new_content) {
-        free(content);
-        return NULL;
-      }
-      content = new_content;
+static int open_input(less_state_t *state, int fd) {
+  struct stat st;
+  int regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+  int compressed = regular && less_decompress_detect(fd);
+  if (regular && !compressed) {
+    size_t size = (size_t)st.st_size;
+    size_t len = size + LESS_FILE_RESERVE;
+    void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE | MAP_NORESERVE, fd, 0);
+    if (map == MAP_FAILED && size > 0) {
+      len = size;
+      map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    if (map != MAP_FAILED) {
+      state->data = map;
+      state->size = size;
+      state->capacity = len;
+      state->file_fd = fd;
+      state->input_eof = 1;
+      state->indexed = size == 0;
+      return 0;
     }
-    memcpy(content + size, buf, (size_t)n);
-    size += (size_t)n;
   }
 
-  content[size] = '\0';
-  return content;
+  for (size_t len = LESS_STREAM_RESERVE; len >= LESS_STREAM_MIN; len /= 2) {
+    void *map = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (map != MAP_FAILED) {
+      state->data = map;
+      state->capacity = len;
+      if (!compressed) {
+        state->source_fd = fd;
+        return 0;
+      }
+      state->dec = less_decompress_start(fd, map, len);
+      if (!state->dec) {
+        int err = errno;
+        munmap(map, len);
+        state->data = NULL;
+        errno = err;
+        return -1;
+      }
+      state->source_fd = less_decompress_fd(state->dec);
+      return 0;
+    }
+  }
+  errno = ENOMEM;
+  return -1;
 }
 
 
 /**
- * Reads entire file content into a dynamically allocated buffer.
+ * Picks up new input: the next chunk of a stream, or data appended to a
+ * mapped file.
  *
- * @param path Path to the file to read.
- * @return Newly allocated content string, or NULL on error.
+ * @param state Pager state.
+ * @return 1 if there is more data or the stream just ended, 0 otherwise.
  */
-static char *read_file_content(const char *path) {
-  FILE *fp = fopen(path, "r");
-  if (!fp) return NULL;
+static int read_more(less_state_t *state) {
+  size_t old_size = state->size;
+
+  if (state->dec) {
+    /* Only the size matters; the wakeups since the last call are dropped */
+    char wakeups[256];
+    ssize_t n = read(state->source_fd, wakeups, sizeof(wakeups));
+    if (n < 0 && errno == EINTR) return 0;
+    state->size = less_decompress_size(state->dec);
+    if (n <= 0) {
+      const char *error = less_decompress_finish(state->dec);
+      if (error) {
+        snprintf(state->status_buf, sizeof(state->status_buf), " %s: %s",
+                 state->filename, error);
+        state->status_msg = state->status_buf;
+      }
+      state->dec = NULL;
+      state->source_fd = -1;
+      state->input_eof = 1;
+      state->indexed = state->scan_pos >= state->size;
+      return 1;
+    }
+  } else if (state->source_fd >= 0) {
+    size_t room = state->capacity - state->size;
+    if (room > LESS_READ_CHUNK) room = LESS_READ_CHUNK;
+    ssize_t n = room > 0 ?
+                read(state->source_fd, state->data + state->size, room) : 0;
+    if (n > 0) {
+      state->size += (size_t)n;
+    } else if (n == 0 || errno != EINTR) {
+      if (room == 0) state->status_msg = " Input too large; rest not shown";
+      if (state->source_fd != STDIN_FILENO) close(state->source_fd);
+      state->source_fd = -1;
+      state->input_eof = 1;
+      state->indexed = state->scan_pos >= state->size;
+      return 1;
+    }
+  } else if (state->file_fd >= 0) {
+    struct stat st;
+    if (fstat(state->file_fd, &st) == 0 && (size_t)st.st_size > state->size) {
+      state->size = (size_t)st.st_size < state->capacity ?
+                    (size_t)st.st_size : state->capacity;
+    }
+  }
 
-  if (fseek(fp, 0, SEEK_END) != 0) {
-    fclose(fp);
-    return NULL;
+  if (state->size == old_size) return 0;
+  state->indexed = 0;
+  return 1;
+}
+
+
+/**
+ * Releases the data buffer and the descriptors behind it.
+ *
+ * @param state Pager state.
+ */
+static void close_input(less_state_t *state) {
+  /* The decompressor writes into data until it is stopped */
+  if (state->dec) {
+    less_decompress_finish(state->dec);
+  } else if (state->source_fd > STDIN_FILENO) {
+    close(state->source_fd);
   }
+  if (state->data) munmap(state->data, state->capacity);
+  if (state->file_fd >= 0) close(state->file_fd);
+}
+
 
-  long size = ftell(fp);
-  if (size < 0) {
-    fclose(fp);
-    return NULL;
+/**
+ * Writes the content to stdout without paging.
+ *
+ * @param data         Content to write.
+ * @param size         Size of the content.
+ * @param line_numbers Whether to prefix each line with its number.
+ */
+static void write_plain(const char *data, size_t size, int line_numbers) {
+  if (!line_numbers) {
+    fwrite(data, 1, size, stdout);
+    if (size > 0 && data[size - 1] != '\n') putchar('\n');
+    return;
   }
 
-  if (fseek(fp, 0, SEEK_SET) != 0) {
-    fclose(fp);
-    return NULL;
+  size_t offset = 0;
+  for (size_t line = 1; offset < size; line++) {
+    const char *nl = memchr(data + offset, '\n', size - offset);
+    size_t end = nl ? (size_t)(nl - data) : size;
+    printf("%6zu  ", line);
+    fwrite(data + offset, 1, end - offset, stdout);
+    putchar('\n');
+    offset = end + 1;
   }
+}
 
-  char *content = malloc((size_t)size + 1);
-  if (!content) {
-    fclose(fp);
-    return NULL;
+
+/**
+ * Checks whether a signal is waiting to be handled.
+ *
+ * @return 1 if a signal flag is set, 0 otherwise.
+ */
+static int signal_pending(void) {
+  return term_resized || term_suspended || term_terminated ||
+         term_interrupted;
+}
+
+
+/**
+ * Waits for a key, or for stream data to read, for up to a timeout.
+ *
+ * @param state      Pager state.
+ * @param timeout_ms Milliseconds to wait; 0 only checks, -1 waits for ever.
+ * @return 1 if a key or signal is waiting to be handled, 0 otherwise.
+ */
+static int wait_for_input(less_state_t *state, int timeout_ms) {
+  if (signal_pending()) return 1;
+
+  struct pollfd pfds[2] = {
+    { .fd = tty_fd, .events = POLLIN },
+    { .fd = state->source_fd, .events = POLLIN },
+  };
+  nfds_t nfds = state->source_fd >= 0 ? 2 : 1;
+  if (poll(pfds, nfds, timeout_ms) < 0) return signal_pending();
+  return pfds[0].revents != 0;
+}
+
+
+/**
+ * Shows data that has just arrived.
+ *
+ * @param state    Pager state.
+ * @param old_size Size of the data before it arrived.
+ */
+static void show_new_data(less_state_t *state, size_t old_size) {
+  if (state->following) {
+    goto_end(state);
+    draw_screen(state);
+  } else if (state->screen_end >= old_size) {
+    /* The screen reached the end of the data, so the new part shows */
+    draw_screen(state);
+  } else {
+    draw_status_line(state, NULL);
   }
+}
 
-  size_t bytes_read = fread(content, 1, (size_t)size, fp);
-  fclose(fp);
 
-  content[bytes_read] = '\0';
-  return content;
+/**
+ * Decompresses a compressed file to its end, counting its lines as it
+ * goes, so that G lands on its last line. A key stops the wait.
+ *
+ * @param state Pager state.
+ */
+static void finish_decompressing(less_state_t *state) {
+  while (state->dec && !signal_pending()) {
+    char msg[64];
+    snprintf(msg, sizeof(msg), " Decompressing... %d%% (any key to stop)",
+             less_decompress_progress(state->dec));
+    draw_status_line(state, msg);
+    if (wait_for_input(state, LESS_POLL_MS)) break;
+    read_more(state);
+    index_step(state, LESS_INDEX_CHUNK);
+  }
 }
 
 
@@ -808,14 +1469,25 @@ static int less_run(int argc, char **argv) {
     return 1;
   }
 
-  char *content = NULL;
-  const char *filename = "(stdin)";
+  less_state_t state = {
+    .data = NULL,
+    .file_fd = -1,
+    .source_fd = -1,
+    .line_pending = 1,
+    .top_line = 0,
+    .show_line_numbers = args.line_numbers->count > 0,
+    .filename = "(stdin)",
+    .ignore_case = args.ignore_case->count > 0,
+    .search_pattern = {0},
+    .status_msg = NULL
+  };
 
   if (args.file->count > 0) {
-    filename = args.file->filename[0];
-    content = read_file_content(filename);
-    if (!content) {
-      fprintf(stderr, "less: %s: %s\n", filename, strerror(errno));
+    state.filename = args.file->filename[0];
+    int fd = open(state.filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || open_input(&state, fd) != 0) {
+      fprintf(stderr, "less: %s: %s\n", state.filename, strerror(errno));
+      if (fd >= 0) close(fd);
       cleanup_less_argtable(&args);
       return 1;
     }
@@ -826,40 +1498,40 @@ static int less_run(int argc, char **argv) {
       cleanup_less_argtable(&args);
       return 1;
     }
-    content = read_stdin_content();
-    if (!content) {
+    if (open_input(&state, STDIN_FILENO) != 0) {
       fprintf(stderr, "less: failed to read stdin\n");
       cleanup_less_argtable(&args);
       return 1;
     }
   }
 
-  size_t line_count;
-  char **lines = split_lines(content, &line_count);
-  free(content);
-
-  if (!lines) {
-    fprintf(stderr, "less: memory allocation failed\n");
+  if (!isatty(STDOUT_FILENO)) {
+    while (state.source_fd >= 0) read_more(&state);
+    write_plain(state.data, state.size, state.show_line_numbers);
+    close_input(&state);
     cleanup_less_argtable(&args);
-    return 1;
+    /* Only set when the input could not be read to its end */
+    if (state.status_msg) {
+      fprintf(stderr, "less:%s\n", state.status_msg);
+      return 1;
+    }
+    return 0;
   }
 
-  if (!isatty(STDOUT_FILENO)) {
-    for (size_t i = 0; i < line_count; i++) {
-      if (args.line_numbers->count > 0) {
-        printf("%6zu  %s\n", i + 1, lines[i]);
-      } else {
-        printf("%s\n", lines[i]);
-      }
+  /* With the data on stdin, keys come from the terminal itself */
+  if (args.file->count == 0) {
+    tty_fd = open("/dev/tty", O_RDONLY | O_CLOEXEC);
+    if (tty_fd < 0) {
+      fprintf(stderr, "less: /dev/tty: %s\n", strerror(errno));
+      close_input(&state);
+      cleanup_less_argtable(&args);
+      return 1;
     }
-    free_lines(lines, line_count);
-    cleanup_less_argtable(&args);
-    return 0;
   }
 
   if (enable_raw_mode() == -1) {
     fprintf(stderr, "less: failed to enable raw mode\n");
-    free_lines(lines, line_count);
+    close_input(&state);
     cleanup_less_argtable(&args);
     return 1;
   }
@@ -884,23 +1556,15 @@ static int less_run(int argc, char **argv) {
   sa.sa_handler = handle_sigint;
   sigaction(SIGINT, &sa, NULL);
 
-  less_state_t state = {
-    .lines = lines,
-    .line_count = line_count,
-    .top_line = 0,
-    .show_line_numbers = args.line_numbers->count > 0,
-    .filename = filename,
-    .search_pattern = {0},
-    .search_matches = NULL,
-    .search_match_count = 0,
-    .current_match = 0
-  };
-
   get_terminal_size(&state.rows, &state.cols);
-  state.line_num_width = count_digits(line_count);
-  if (state.line_num_width < 4) state.line_num_width = 4;
+  state.screen = jbox_screen_new(STDOUT_FILENO, state.rows, state.cols);
+  if (!state.screen) {
+    fprintf(stderr, "less: out of memory\n");
+    close_input(&state);
+    cleanup_less_argtable(&args);
+    return 1;
+  }
 
-  clear_screen();
   draw_screen(&state);
 
   int running = 1;
@@ -931,12 +1595,39 @@ static int less_run(int argc, char **argv) {
 
     if (term_resized) {
       term_resized = 0;
-      get_terminal_size(&state.rows, &state.cols);
-      clear_screen();
+      resize_screen(&state);
       draw_screen(&state);
     }
 
+    /* Index, read input and follow the search until a key arrives */
+    while (!signal_pending()) {
+      int searching = search_poll(&state);
+      if (state.scan_pos < state.size) {
+        if (wait_for_input(&state, 0)) break;
+        index_step(&state, LESS_INDEX_CHUNK);
+        draw_status_line(&state, NULL);
+        continue;
+      }
+
+      int watching = state.following && state.file_fd >= 0;
+      if (!searching && !watching && state.source_fd < 0) break;
+      if (wait_for_input(&state, searching || watching ? LESS_POLL_MS : -1)) {
+        break;
+      }
+      size_t old_size = state.size;
+      if (read_more(&state)) show_new_data(&state, old_size);
+    }
+    if (signal_pending()) continue;
+
     int key = read_key();
+    if (key >= 0) state.status_msg = NULL;
+
+    /* Any key ends F */
+    if (state.following && key >= 0) {
+      state.following = 0;
+      draw_screen(&state);
+      continue;
+    }
 
     switch (key) {
       case 'q':
@@ -975,6 +1666,14 @@ static int less_run(int argc, char **argv) {
         break;
 
       case 'G':
+        finish_decompressing(&state);
+        goto_end(&state);
+        draw_screen(&state);
+        break;
+
+      case 'F':
+        state.following = 1;
+        state.status_msg = " Waiting for data... (press any key to stop)";
         goto_end(&state);
         draw_screen(&state);
         break;
@@ -1004,11 +1703,19 @@ static int less_run(int argc, char **argv) {
     }
   }
 
-  clear_screen();
-  move_cursor(1, 1);
-
-  free(state.search_matches);
-  free_lines(lines, line_count);
+  jbox_screen_clear(state.screen);
+  jbox_screen_set_cursor(state.screen, 0, 0);
+  jbox_screen_flush(state.screen);
+  jbox_screen_free(state.screen);
+
+  search_stop(&state);
+  free(state.line_offsets);
+  close_input(&state);
+  if (tty_fd != STDIN_FILENO) {
+    disable_raw_mode();
+    close(tty_fd);
+    tty_fd = STDIN_FILENO;
+  }
   cleanup_less_argtable(&args);
 
   return exit_code;
@@ -1023,10 +1730,12 @@ const jshell_cmd_spec_t cmd_less_spec = {
   .summary = "view file contents with paging",
   .long_help = "View FILE contents with paging. "
                "Supports navigation with arrow keys, j/k, space/b, "
-               "and search with /pattern.",
+               "and search with /pattern, an extended regular expression "
+               "searched in the background.",
   .type = CMD_EXTERNAL,
   .run = less_run,
-  .print_usage = less_print_usage
+  .print_usage = less_print_usage,
+  .describe_args = less_describe_args
 };
 
 
@@ -0,0 +1,283 @@
+/**
+ * @file less_decompress.c
+ * @brief Streaming gzip and zstd decompression into the pager's buffer.
+ *
+ * The thread reads the file a chunk at a time and inflates it in place
+ * at the end of what it has produced, publishing the new size with a
+ * release store, so the pager reads the text with no copy and no lock.
+ * After each step it writes a byte to a non-blocking pipe; a full pipe
+ * already means the pager has something to pick up.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <zstd.h>
+
+#include "less_decompress.h"
+
+
+/** Compressed bytes read at a time */
+#define LESS_DECOMPRESS_CHUNK (128 * 1024)
+
+/** Most bytes decompressed between two wakeups of the pager */
+#define LESS_DECOMPRESS_STEP (1024 * 1024)
+
+
+typedef enum {
+  LESS_FORMAT_PLAIN,
+  LESS_FORMAT_GZIP,
+  LESS_FORMAT_ZSTD
+} less_format_t;
+
+
+struct less_decompress {
+  int in_fd;                /**< Compressed file */
+  size_t in_size;           /**< Its size, for progress */
+  less_format_t format;
+  char *out;                /**< Buffer being filled */
+  size_t capacity;          /**< Bytes of out that may be written */
+  atomic_size_t produced;   /**< Bytes of out written */
+  atomic_size_t consumed;   /**< Bytes of the file read */
+  atomic_int cancel;        /**< Set to stop the thread early */
+  int notify_rd;            /**< Pager's end of the wakeup pipe */
+  int notify_wr;            /**< Thread's end, closed when it is done */
+  pthread_t thread;
+  const char *error;        /**< Set by the thread, read after joining */
+};
+
+
+/**
+ * Tells the format of a file from its first bytes.
+ *
+ * @param p   First bytes.
+ * @param len Number of bytes (at most 4).
+ * @return Format, LESS_FORMAT_PLAIN if neither gzip nor zstd.
+ */
+static less_format_t detect_format(const unsigned char *p, size_t len) {
+  if (len >= 2 && p[0] == 0x1f && p[1] == 0x8b) return LESS_FORMAT_GZIP;
+  if (len == 4) {
+    unsigned long magic = (unsigned long)p[0] | (unsigned long)p[1] << 8
+                          | (unsigned long)p[2] << 16
+                          | (unsigned long)p[3] << 24;
+    /* A frame, or a skippable frame before one */
+    if (magic == 0xFD2FB528ul || (magic & 0xFFFFFFF0ul) == 0x184D2A50ul) {
+      return LESS_FORMAT_ZSTD;
+    }
+  }
+  return LESS_FORMAT_PLAIN;
+}
+
+
+/**
+ * Reads the first bytes of a file and tells its format.
+ *
+ * @param fd Descriptor of the file.
+ * @return Format, LESS_FORMAT_PLAIN if unreadable.
+ */
+static less_format_t file_format(int fd) {
+  unsigned char magic[4];
+  ssize_t n;
+  do {
+    n = pread(fd, magic, sizeof(magic), 0);
+  } while (n < 0 && errno == EINTR);
+  return n > 0 ? detect_format(magic, (size_t)n) : LESS_FORMAT_PLAIN;
+}
+
+
+bool less_decompress_detect(int fd) {
+  return file_format(fd) != LESS_FORMAT_PLAIN;
+}
+
+
+/**
+ * Publishes decompressed bytes and wakes the pager.
+ *
+ * @param dec      Decompressor.
+ * @param produced New size of the output.
+ */
+static void publish(less_decompress_t *dec, size_t produced) {
+  atomic_store_explicit(&dec->produced, produced, memory_order_release);
+  ssize_t n;
+  do {
+    n = write(dec->notify_wr, "", 1);
+  } while (n < 0 && errno == EINTR);
+}
+
+
+/**
+ * Decompressor thread: inflates the file into the buffer until its end,
+ * an error or a cancel.
+ *
+ * @param arg less_decompress_t.
+ * @return NULL.
+ */
+static void *decompress_thread(void *arg) {
+  less_decompress_t *dec = arg;
+  unsigned char *ibuf = malloc(LESS_DECOMPRESS_CHUNK);
+  z_stream z = {0};
+  bool z_ready = false;
+  ZSTD_DCtx *dctx = NULL;
+
+  if (!ibuf) {
+    dec->error = "out of memory";
+  } else if (dec->format == LESS_FORMAT_GZIP) {
+    z_ready = inflateInit2(&z, 16 + MAX_WBITS) == Z_OK;
+    if (!z_ready) dec->error = "out of memory";
+  } else {
+    dctx = ZSTD_createDCtx();
+    if (!dctx) dec->error = "out of memory";
+  }
+
+  const unsigned char *data = ibuf;
+  size_t len = 0;
+  size_t consumed = 0;
+  size_t produced = 0;
+  bool at_end = false;      /* The last member or frame ended */
+  while (!dec->error && !atomic_load(&dec->cancel)) {
+    if (len == 0) {
+      ssize_t n = read(dec->in_fd, ibuf, LESS_DECOMPRESS_CHUNK);
+      if (n < 0 && errno == EINTR) continue;
+      if (n < 0) {
+        dec->error = strerror(errno);
+        break;
+      }
+      if (n == 0) {
+        if (!at_end) dec->error = "unexpected end of compressed data";
+        break;
+      }
+      data = ibuf;
+      len = (size_t)n;
+      consumed += (size_t)n;
+      atomic_store_explicit(&dec->consumed, consumed, memory_order_relaxed);
+    }
+
+    size_t room = dec->capacity - produced;
+    if (room == 0) {
+      dec->error = "file too large to decompress; rest not shown";
+      break;
+    }
+    if (room > LESS_DECOMPRESS_STEP) room = LESS_DECOMPRESS_STEP;
+
+    size_t used, made;
+    if (dec->format == LESS_FORMAT_GZIP) {
+      /* Concatenated members, as pigz and logrotate append, are one file */
+      if (at_end) inflateReset(&z);
+      z.next_in = (Bytef *)data;
+      z.avail_in = (uInt)len;
+      z.next_out = (Bytef *)dec->out + produced;
+      z.avail_out = (uInt)room;
+      int zrc = inflate(&z, Z_NO_FLUSH);
+      if (zrc != Z_OK && zrc != Z_STREAM_END && zrc != Z_BUF_ERROR) {
+        dec->error = "invalid compressed data";
+        break;
+      }
+      at_end = zrc == Z_STREAM_END;
+      used = len - z.avail_in;
+      made = room - z.avail_out;
+    } else {
+      ZSTD_inBuffer zin = { data, len, 0 };
+      ZSTD_outBuffer zout = { dec->out + produced, room, 0 };
+      size_t zrc = ZSTD_decompressStream(dctx, &zout, &zin);
+      if (ZSTD_isError(zrc)) {
+        dec->error = "invalid compressed data";
+        break;
+      }
+      at_end = zrc == 0;
+      used = zin.pos;
+      made = zout.pos;
+    }
+    data += used;
+    len -= used;
+
+    if (made > 0) {
+      produced += made;
+      publish(dec, produced);
+    }
+  }
+
+  /* End of file for the pager */
+  close(dec->notify_wr);
+  dec->notify_wr = -1;
+  if (z_ready) inflateEnd(&z);
+  ZSTD_freeDCtx(dctx);
+  free(ibuf);
+  return NULL;
+}
+
+
+less_decompress_t *less_decompress_start(int fd, char *out, size_t capacity) {
+  less_format_t format = file_format(fd);
+  if (format == LESS_FORMAT_PLAIN) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  less_decompress_t *dec = calloc(1, sizeof(*dec));
+  if (!dec) return NULL;
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) != 0) {
+    free(dec);
+    return NULL;
+  }
+  fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+  struct stat st;
+  dec->in_fd = fd;
+  dec->in_size = fstat(fd, &st) == 0 ? (size_t)st.st_size : 0;
+  dec->format = format;
+  dec->out = out;
+  dec->capacity = capacity;
+  dec->notify_rd = fds[0];
+  dec->notify_wr = fds[1];
+
+  int err = pthread_create(&dec->thread, NULL, decompress_thread, dec);
+  if (err != 0) {
+    close(fds[0]);
+    close(fds[1]);
+    free(dec);
+    errno = err;
+    return NULL;
+  }
+  return dec;
+}
+
+
+int less_decompress_fd(const less_decompress_t *dec) {
+  return dec->notify_rd;
+}
+
+
+size_t less_decompress_size(less_decompress_t *dec) {
+  return atomic_load_explicit(&dec->produced, memory_order_acquire);
+}
+
+
+int less_decompress_progress(less_decompress_t *dec) {
+  if (dec->in_size == 0) return 100;
+  size_t consumed = atomic_load_explicit(&dec->consumed,
+                                         memory_order_relaxed);
+  return (int)(100.0 * (double)consumed / (double)dec->in_size);
+}
+
+
+const char *less_decompress_finish(less_decompress_t *dec) {
+  if (!dec) return NULL;
+
+  atomic_store(&dec->cancel, 1);
+  pthread_join(dec->thread, NULL);
+
+  const char *error = dec->error;
+  close(dec->notify_rd);
+  close(dec->in_fd);
+  free(dec);
+  return error;
+}
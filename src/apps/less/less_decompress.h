@@ -0,0 +1,79 @@
+/**
+ * @file less_decompress.h
+ * @brief Transparent viewing of gzip and zstd files.
+ *
+ * A compressed file is inflated on a thread of its own straight into the
+ * pager's buffer, the reservation piped input is read into, so the first
+ * page shows as soon as it is decompressed and the rest keeps arriving
+ * while the pager is in use. The thread wakes the pager through a pipe,
+ * which the pager polls like the one a stream arrives on, and which
+ * reaches end of file once the thread has finished. Everything inflated
+ * stays in the buffer, so no part of the file is ever decompressed twice,
+ * whatever the jumps.
+ */
+
+#ifndef LESS_DECOMPRESS_H
+#define LESS_DECOMPRESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct less_decompress less_decompress_t;
+
+
+/**
+ * Tells from its first bytes whether a file holds gzip or zstd data.
+ *
+ * @param fd Descriptor of a regular file; its offset is not moved.
+ * @return true if the file is compressed.
+ */
+bool less_decompress_detect(int fd);
+
+/**
+ * Starts decompressing a file into a buffer.
+ *
+ * @param fd       Descriptor of the compressed file; owned by the
+ *                 decompressor afterwards.
+ * @param out      Buffer to decompress into.
+ * @param capacity Bytes of out that may be written.
+ * @return The decompressor, or NULL on error (errno set; fd not closed).
+ */
+less_decompress_t *less_decompress_start(int fd, char *out, size_t capacity);
+
+/**
+ * Gives the descriptor that becomes readable as data is decompressed.
+ * The bytes read from it carry no meaning; it reads end of file once
+ * the decompressor has finished.
+ *
+ * @param dec Decompressor.
+ * @return Read end of the wakeup pipe, owned by the decompressor.
+ */
+int less_decompress_fd(const less_decompress_t *dec);
+
+/**
+ * Gives the bytes decompressed into the buffer so far.
+ *
+ * @param dec Decompressor.
+ * @return Bytes at the start of the buffer that may be read.
+ */
+size_t less_decompress_size(less_decompress_t *dec);
+
+/**
+ * Gives how much of the compressed file has been read.
+ *
+ * @param dec Decompressor.
+ * @return Percentage of the file, 0 to 100.
+ */
+int less_decompress_progress(less_decompress_t *dec);
+
+/**
+ * Stops the thread if it is still running, frees the decompressor and
+ * closes its descriptors.
+ *
+ * @param dec Decompressor, or NULL.
+ * @return NULL if the file was decompressed to its end, otherwise why
+ *         it was not, as a static string.
+ */
+const char *less_decompress_finish(less_decompress_t *dec);
+
+#endif /* LESS_DECOMPRESS_H */
@@ -3,11 +3,17 @@
  * @brief Implementation of the ls command for listing directory contents.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <pwd.h>
 #include <grp.h>
 #include <time.h>
@@ -16,6 +22,151 @@
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_ctx.h"
+#include "utils/jbox_json.h"
+#include "utils/jbox_record.h"
+
+
+/** Size of the buffer handed to each getdents64() call */
+#define LS_DENTS_BUFFER (256 * 1024)
+
+/** Largest record getdents64() returns, for sizing reads of a page */
+#define LS_DENT_MAX sizeof(struct dirent64)
+
+/** Size of stdout's buffer */
+#define LS_OUT_BUFFER (64 * 1024)
+
+/** Directories with fewer entries to stat are stat'ed on the main thread */
+#define LS_STAT_PARALLEL_MIN 512
+
+/** Entries a stat worker claims at a time */
+#define LS_STAT_CHUNK 64
+
+/** Upper bound on stat threads, whatever the core count */
+#define LS_MAX_WORKERS 16
+
+/** Orders entries can be listed in */
+enum {
+  LS_SORT_NAME,
+  LS_SORT_SIZE,
+  LS_SORT_TIME,
+  LS_SORT_NONE
+};
+
+/** Directory records from getdents64(), allocated per invocation */
+static thread_local char *ls_dents_buffer;
+
+/** stdout buffer, so large listings go out in few writes */
+static char ls_out_buffer[LS_OUT_BUFFER];
+
+
+/**
+ * Where a --limit page starts: just after the last entry of the one
+ * before. Handed out as an opaque --cursor token by format_cursor().
+ */
+typedef struct {
+  unsigned long long dir_ino;   /* Directory the cursor belongs to */
+  int sort;                     /* LS_SORT_* the pages are in */
+  int reverse;
+  unsigned long long offset;    /* LS_SORT_NONE: getdents64 offset to
+                                   resume reading at */
+  off_t size;                   /* LS_SORT_SIZE: the last entry's size */
+  struct timespec mtime;        /* LS_SORT_TIME: the last entry's mtime */
+  char *name;                   /* Sorted orders: the last entry's name */
+} ls_cursor_t;
+
+/** How entries are listed */
+typedef struct {
+  int show_all;
+  int show_long;
+  int show_json;            /* --json or --json-stream */
+  int json_stream;
+  int sort;
+  int reverse;
+  int recursive;
+  int max_depth;            /* Levels below each PATH, -1 for no limit */
+  unsigned int stat_mask;   /* STATX_* fields the output needs, 0 for none */
+  int paged;                /* --limit or --cursor: list one page */
+  size_t limit;             /* Entries per page, 0 for the rest */
+  const ls_cursor_t *cursor;  /* Where the page starts, or NULL */
+  jbox_record_t *record;    /* --json-stream objects go out as records to
+                               the next stage, or NULL for NDJSON */
+} ls_opts_t;
+
+/** One directory entry */
+typedef struct {
+  size_t name;              /* Offset of the name in ls_dir_t.names */
+  unsigned char type;       /* DT_* from getdents64(), maybe DT_UNKNOWN */
+  int err;                  /* errno of a failed stat, else 0 */
+  struct stat *st;          /* NULL unless stat'ed successfully */
+} ls_entry_t;
+
+/** Entries of one directory, read in full before any is printed */
+typedef struct ls_dir {
+  char *names;              /* NUL-terminated names, back to back */
+  size_t names_len;
+  size_t names_cap;
+  ls_entry_t *entries;
+  size_t count;
+  size_t cap;
+  struct stat *stats;       /* One per entry when stat'ed, else NULL */
+  int more;                 /* Paged: entries are left after these */
+  unsigned long long resume;  /* Paged, unsorted: getdents64 offset just
+                                 after the last entry */
+} ls_dir_t;
+
+/** Cached uid or gid to name lookup */
+typedef struct {
+  unsigned int id;
+  char *name;               /* NULL if the id has no name */
+} ls_id_name_t;
+
+typedef struct {
+  ls_id_name_t *items;
+  size_t count;
+  size_t cap;
+} ls_id_cache_t;
+
+static thread_local ls_id_cache_t ls_users;
+static thread_local ls_id_cache_t ls_groups;
+
+/** Path of the directory being listed, grown and cut back while recursing */
+typedef struct {
+  char *buf;
+  size_t len;
+  size_t cap;
+} ls_path_t;
+
+/**
+ * Threads that stat the entries of large directories.
+ *
+ * The main thread posts one directory at a time as a job; every worker
+ * and the main thread then claim LS_STAT_CHUNK entries at a time from
+ * `next` until none are left, and the main thread waits for the workers
+ * to report back before it sorts and prints.
+ */
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t wake;      /* A job was posted, or stop was set */
+  pthread_cond_t idle;      /* A worker finished the current job */
+  pthread_t threads[LS_MAX_WORKERS];
+  int nthreads;
+  int tried;                /* Workers were started, or could not be */
+  int stop;
+  unsigned long job;        /* Bumped for each posted directory */
+  int active;               /* Workers yet to finish the current job */
+  int fd;
+  struct ls_dir *dir;
+  unsigned int mask;
+  atomic_size_t next;
+} ls_stat_pool_t;
+
+/** One pool per invoking thread; its workers are handed a pointer to it */
+static thread_local ls_stat_pool_t ls_pool = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .wake = PTHREAD_COND_INITIALIZER,
+  .idle = PTHREAD_COND_INITIALIZER
+};
 
 /**
  * Arguments structure for the ls command.
@@ -24,10 +175,20 @@ typedef struct {
   struct arg_lit *help;
   struct arg_lit *all;
   struct arg_lit *longfmt;
+  struct arg_lit *by_size;
+  struct arg_lit *by_time;
+  struct arg_lit *unsorted;
+  struct arg_lit *reverse;
+  struct arg_str *sort;
+  struct arg_lit *recursive;
+  struct arg_int *max_depth;
+  struct arg_int *limit;
+  struct arg_str *cursor;
   struct arg_lit *json;
+  struct arg_lit *json_stream;
   struct arg_file *paths;
   struct arg_end *end;
-  void *argtable[6];
+  void *argtable[16];
 } ls_args_t;
 
 /**
@@ -39,16 +200,48 @@ static void build_ls_argtable(ls_args_t *args) {
   args->help    = arg_lit0("h", "help", "display this help and exit");
   args->all     = arg_lit0("a", NULL, "do not ignore entries starting with .");
   args->longfmt = arg_lit0("l", NULL, "use long listing format");
-  args->json    = arg_lit0(NULL, "json", "output in JSON format");
+  args->by_size = arg_lit0("S", NULL, "sort by file size, largest first");
+  args->by_time = arg_lit0("t", NULL,
+                           "sort by modification time, newest first");
+  args->unsorted = arg_lit0("U", NULL, "do not sort; list in directory order");
+  args->reverse = arg_lit0("r", "reverse", "reverse order while sorting");
+  args->sort    = arg_str0(NULL, "sort", "WORD",
+                           "sort by WORD: name, size, time or none");
+  args->recursive = arg_lit0("R", "recursive",
+                             "list subdirectories recursively");
+  args->max_depth = arg_int0(NULL, "max-depth", "N",
+                             "with -R, descend at most N levels below each "
+                             "PATH");
+  args->limit   = arg_int0(NULL, "limit", "N",
+                           "list at most N entries of the directory, then a "
+                           "cursor to resume from");
+  args->cursor  = arg_str0(NULL, "cursor", "TOKEN",
+                           "resume a --limit listing where the last page "
+                           "ended");
+  args->json    = arg_lit0(NULL, "json",
+                           "output in JSON format; with -R, as a tree");
+  args->json_stream = arg_lit0(NULL, "json-stream",
+                               "output one JSON object per line (NDJSON) "
+                               "with its path");
   args->paths   = arg_filen(NULL, NULL, "PATH", 0, 100, "files or directories to list");
   args->end     = arg_end(20);
 
   args->argtable[0] = args->help;
   args->argtable[1] = args->all;
   args->argtable[2] = args->longfmt;
-  args->argtable[3] = args->json;
-  args->argtable[4] = args->paths;
-  args->argtable[5] = args->end;
+  args->argtable[3] = args->by_size;
+  args->argtable[4] = args->by_time;
+  args->argtable[5] = args->unsorted;
+  args->argtable[6] = args->reverse;
+  args->argtable[7] = args->sort;
+  args->argtable[8] = args->recursive;
+  args->argtable[9] = args->max_depth;
+  args->argtable[10] = args->limit;
+  args->argtable[11] = args->cursor;
+  args->argtable[12] = args->json;
+  args->argtable[13] = args->json_stream;
+  args->argtable[14] = args->paths;
+  args->argtable[15] = args->end;
 }
 
 /**
@@ -76,6 +269,39 @@ static void ls_print_usage(FILE *out) {
   cleanup_ls_argtable(&args);
 }
 
+/**
+ * Passes the ls argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void ls_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  ls_args_t args;
+  build_ls_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_ls_argtable(&args);
+}
+
+/**
+ * Tells the result cache what the output of ls depends on: the named paths
+ * and the entries of named directories; with -R, everything below them.
+ *
+ * @param argc Number of arguments
+ * @param argv Array of argument strings
+ * @return How this run may be cached
+ */
+static jshell_cmd_cache_t ls_cache_scope(int argc, char **argv) {
+  ls_args_t args;
+  build_ls_argtable(&args);
+  int nerrors = arg_parse(argc, argv, args.argtable);
+  jshell_cmd_cache_t scope = CMD_CACHE_NONE;
+  if (nerrors == 0 && args.help->count == 0) {
+    scope = args.recursive->count > 0 ? CMD_CACHE_TREES : CMD_CACHE_FILES;
+  }
+  cleanup_ls_argtable(&args);
+  return scope;
+}
+
 /**
  * Returns a single character representing the file type.
  *
@@ -129,124 +355,1068 @@ static const char *get_file_type_string(mode_t mode) {
 }
 
 /**
- * Escapes special characters in a string for JSON output.
- *
- * @param str      The input string to escape.
- * @param out      Buffer to write the escaped string to.
- * @param out_size Size of the output buffer.
- */
-static void escape_json_string(const char *str, char *out, size_t out_size) {
-  size_t j = 0;
-  for (size_t i = 0; str[i] && j < out_size - 1; i++) {
-    char c = str[i];
-    if (c == '"' || c == '\\') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = c;
-    } else if (c == '\n') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = 'n';
-    } else if (c == '\r') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = 'r';
-    } else if (c == '\t') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = 't';
-    } else {
-      out[j++] = c;
+ * Looks up a user or group name, asking the system once per id.
+ *
+ * @param cache Cache for the kind of id.
+ * @param id    User or group id.
+ * @param group If non-zero, id is a gid, otherwise a uid.
+ * @return The name, or "unknown" if the id has none.
+ */
+static const char *lookup_id_name(ls_id_cache_t *cache, unsigned int id,
+                                  int group) {
+  for (size_t i = 0; i < cache->count; i++) {
+    if (cache->items[i].id == id) {
+      return cache->items[i].name ? cache->items[i].name : "unknown";
+    }
+  }
+
+  /* The _r variants: another app may be looking up names on its thread */
+  char buf[1024];
+  const char *name = NULL;
+  if (group) {
+    struct group gr, *res;
+    if (getgrgid_r((gid_t)id, &gr, buf, sizeof(buf), &res) == 0 && res) {
+      name = res->gr_name;
+    }
+  } else {
+    struct passwd pw, *res;
+    if (getpwuid_r((uid_t)id, &pw, buf, sizeof(buf), &res) == 0 && res) {
+      name = res->pw_name;
     }
   }
-  out[j] = '\0';
+
+  if (cache->count == cache->cap) {
+    size_t cap = cache->cap ? cache->cap * 2 : 8;
+    ls_id_name_t *items = realloc(cache->items, cap * sizeof(*items));
+    if (!items) {
+      return name ? name : "unknown";
+    }
+    cache->items = items;
+    cache->cap = cap;
+  }
+  ls_id_name_t *item = &cache->items[cache->count++];
+  item->id = id;
+  item->name = name ? strdup(name) : NULL;
+  return item->name ? item->name : "unknown";
+}
+
+/**
+ * Frees a name cache.
+ *
+ * @param cache Cache to empty.
+ */
+static void free_id_cache(ls_id_cache_t *cache) {
+  for (size_t i = 0; i < cache->count; i++) {
+    free(cache->items[i].name);
+  }
+  free(cache->items);
+  cache->items = NULL;
+  cache->count = 0;
+  cache->cap = 0;
+}
+
+/**
+ * Joins a directory and an entry name into the entry's path.
+ *
+ * @param dir_path Directory holding the entry.
+ * @param name     Entry name.
+ * @return Newly allocated path, or NULL if out of memory.
+ */
+static char *join_entry_path(const char *dir_path, const char *name) {
+  size_t len = strlen(dir_path);
+  char *full = malloc(len + strlen(name) + 2);
+  if (full) {
+    int slash = len > 0 && dir_path[len - 1] != '/';
+    sprintf(full, "%s%s%s", dir_path, slash ? "/" : "", name);
+  }
+  return full;
+}
+
+/**
+ * Prints an entry's JSON object up to, not including, its closing brace.
+ *
+ * @param name     Entry name.
+ * @param dir_path Directory holding the entry, or NULL for a PATH argument;
+ *                 under --json-stream it is prefixed to form "path".
+ * @param st       The entry's stat.
+ * @param opts     Listing options.
+ */
+static void print_json_fields(const char *name, const char *dir_path,
+                              const struct stat *st, const ls_opts_t *opts) {
+  if (opts->json_stream) {
+    fputs("{\"path\": ", jbox_stdout());
+    char *full = dir_path ? join_entry_path(dir_path, name) : NULL;
+    jbox_json_write_string(jbox_stdout(), full ? full : name);
+    free(full);
+    fputs(", \"name\": ", jbox_stdout());
+  } else {
+    fputs("{\"name\": ", jbox_stdout());
+  }
+  jbox_json_write_string(jbox_stdout(), name);
+  jbox_printf(", \"type\": \"%s\", \"size\": %ld, \"mtime\": %ld",
+              get_file_type_string(st->st_mode),
+              (long)st->st_size, (long)st->st_mtime);
+
+  if (opts->show_long) {
+    char perms[12];
+    format_permissions(st->st_mode, perms);
+
+    jbox_printf(", \"mode\": \"%s\", \"nlink\": %ld, \"owner\": \"%s\", "
+                "\"group\": \"%s\"",
+                perms, (long)st->st_nlink,
+                lookup_id_name(&ls_users, st->st_uid, 0),
+                lookup_id_name(&ls_groups, st->st_gid, 1));
+  }
+}
+
+/**
+ * Sends an entry to the next stage as a record, with the members
+ * print_json_fields() would print under --json-stream.
+ *
+ * @param name     Entry name.
+ * @param dir_path Directory holding the entry, or NULL for a PATH argument.
+ * @param st       The entry's stat.
+ * @param opts     Listing options, with a record to fill.
+ */
+static void write_entry_record(const char *name, const char *dir_path,
+                               const struct stat *st, const ls_opts_t *opts) {
+  jbox_record_t *rec = opts->record;
+  jbox_record_clear(rec);
+  char *full = dir_path ? join_entry_path(dir_path, name) : NULL;
+  jbox_record_add_string(rec, "path", full ? full : name);
+  free(full);
+  jbox_record_add_string(rec, "name", name);
+  jbox_record_add_string(rec, "type", get_file_type_string(st->st_mode));
+  jbox_record_add_int(rec, "size", (long long)st->st_size);
+  jbox_record_add_int(rec, "mtime", (long long)st->st_mtime);
+
+  if (opts->show_long) {
+    char perms[12];
+    format_permissions(st->st_mode, perms);
+    jbox_record_add_string(rec, "mode", perms);
+    jbox_record_add_int(rec, "nlink", (long long)st->st_nlink);
+    jbox_record_add_string(rec, "owner",
+                           lookup_id_name(&ls_users, st->st_uid, 0));
+    jbox_record_add_string(rec, "group",
+                           lookup_id_name(&ls_groups, st->st_gid, 1));
+  }
+  jbox_record_write(jbox_stdout(), rec, true);
+}
+
+/**
+ * Starts an element of the --json array: separator and indentation.
+ *
+ * @param depth       Nesting level, 0 for the top of the array.
+ * @param first_entry Pointer to flag tracking if this is the first entry
+ *                    of its array.
+ */
+static void begin_json_element(int depth, int *first_entry) {
+  if (!*first_entry) {
+    fputs(",\n", jbox_stdout());
+  }
+  *first_entry = 0;
+  jbox_printf("%*s", 4 + 4 * depth, "");
 }
 
 /**
- * Lists the contents of a directory.
+ * Prints one entry in the selected format.
  *
- * @param path        Path to the directory to list.
- * @param show_all    If non-zero, include hidden entries.
- * @param show_long   If non-zero, use long listing format.
- * @param show_json   If non-zero, output in JSON format.
+ * @param name        Name to print.
+ * @param dir_path    Directory holding the entry, or NULL for a PATH argument.
+ * @param st          The entry's stat, or NULL in short text mode.
+ * @param opts        Listing options.
+ * @param depth       Nesting level in --json tree output.
  * @param first_entry Pointer to flag tracking if this is the first JSON entry.
- * @return 0 on success, 1 on error.
  */
-static int list_directory(const char *path, int show_all, int show_long, int show_json, int *first_entry) {
-  DIR *dir = opendir(path);
-  if (!dir) {
-    if (!show_json) {
-      fprintf(stderr, "ls: cannot access '%s': %s\n", path, strerror(errno));
+static void print_entry(const char *name, const char *dir_path,
+                        const struct stat *st, const ls_opts_t *opts,
+                        int depth, int *first_entry) {
+  if (opts->record) {
+    write_entry_record(name, dir_path, st, opts);
+  } else if (opts->json_stream) {
+    print_json_fields(name, dir_path, st, opts);
+    fputs("}\n", jbox_stdout());
+  } else if (opts->show_json) {
+    begin_json_element(depth, first_entry);
+    print_json_fields(name, dir_path, st, opts);
+    fputs("}", jbox_stdout());
+  } else if (opts->show_long) {
+    char perms[12];
+    format_permissions(st->st_mode, perms);
+
+    char timebuf[64];
+    struct tm tm;
+    localtime_r(&st->st_mtime, &tm);
+    strftime(timebuf, sizeof(timebuf), "%b %d %H:%M", &tm);
+
+    jbox_printf("%s %3ld %-8s %-8s %8ld %s %s\n",
+                perms, (long)st->st_nlink,
+                lookup_id_name(&ls_users, st->st_uid, 0),
+                lookup_id_name(&ls_groups, st->st_gid, 1),
+                (long)st->st_size, timebuf, name);
+  } else {
+    fputs(name, jbox_stdout());
+    fputc('\n', jbox_stdout());
+  }
+}
+
+/**
+ * Reports a path that cannot be listed.
+ *
+ * Text output writes to stderr; --json-stream emits an object with an
+ * "error" member, so consumers see which subtree is missing. Plain
+ * --json stays silent, as it always has.
+ *
+ * @param what Description of the failed step, e.g. "cannot access".
+ * @param path Path that failed.
+ * @param err  errno of the failure.
+ * @param opts Listing options.
+ */
+static void report_path_error(const char *what, const char *path, int err,
+                             const ls_opts_t *opts) {
+  if (opts->record) {
+    jbox_record_clear(opts->record);
+    jbox_record_add_string(opts->record, "path", path);
+    jbox_record_add_string(opts->record, "error", strerror(err));
+    jbox_record_write(jbox_stdout(), opts->record, true);
+  } else if (opts->json_stream) {
+    fputs("{\"path\": ", jbox_stdout());
+    jbox_json_write_string(jbox_stdout(), path);
+    fputs(", \"error\": ", jbox_stdout());
+    jbox_json_write_string(jbox_stdout(), strerror(err));
+    fputs("}\n", jbox_stdout());
+  } else if (!opts->show_json) {
+    fprintf(stderr, "ls: %s '%s': %s\n", what, path, strerror(err));
+  }
+}
+
+/**
+ * Appends an entry to a directory listing.
+ *
+ * @param dir  Listing to append to.
+ * @param name Entry name.
+ * @param len  Length of name.
+ * @param type DT_* type of the entry.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int add_entry(ls_dir_t *dir, const char *name, size_t len,
+                     unsigned char type) {
+  if (dir->count == dir->cap) {
+    size_t cap = dir->cap ? dir->cap * 2 : 256;
+    ls_entry_t *entries = realloc(dir->entries, cap * sizeof(*entries));
+    if (!entries) return -1;
+    dir->entries = entries;
+    dir->cap = cap;
+  }
+  if (dir->names_len + len + 1 > dir->names_cap) {
+    size_t cap = dir->names_cap ? dir->names_cap * 2 : 8192;
+    while (cap < dir->names_len + len + 1) cap *= 2;
+    char *names = realloc(dir->names, cap);
+    if (!names) return -1;
+    dir->names = names;
+    dir->names_cap = cap;
+  }
+
+  ls_entry_t *entry = &dir->entries[dir->count++];
+  entry->name = dir->names_len;
+  entry->type = type;
+  entry->err = 0;
+  entry->st = NULL;
+  memcpy(dir->names + dir->names_len, name, len + 1);
+  dir->names_len += len + 1;
+  return 0;
+}
+
+/**
+ * Reads every entry of an open directory with getdents64().
+ *
+ * Records come straight from the kernel in LS_DENTS_BUFFER batches, so
+ * a large directory costs a handful of system calls rather than one
+ * readdir() refill per few dozen entries.
+ *
+ * @param fd       Directory descriptor.
+ * @param show_all If non-zero, keep entries starting with '.'.
+ * @param dir      Listing to fill.
+ * @return 0 on success, -1 on error (errno set).
+ */
+static int read_entries(int fd, int show_all, ls_dir_t *dir) {
+  for (;;) {
+    ssize_t n = getdents64(fd, ls_dents_buffer, LS_DENTS_BUFFER);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    if (n == 0) return 0;
+
+    for (ssize_t off = 0; off < n; ) {
+      struct dirent64 *d = (struct dirent64 *)(ls_dents_buffer + off);
+      off += d->d_reclen;
+      if (!show_all && d->d_name[0] == '.') continue;
+      if (add_entry(dir, d->d_name, strlen(d->d_name), d->d_type) != 0) {
+        errno = ENOMEM;
+        return -1;
+      }
     }
-    return 1;
   }
+}
 
-  struct dirent *entry;
-  while ((entry = readdir(dir)) != NULL) {
-    if (!show_all && entry->d_name[0] == '.') {
-      continue;
+/**
+ * Reads one page of an unsorted listing: up to opts->limit entries in
+ * directory order, from the cursor's offset on.
+ *
+ * Reads are sized to the page, so the kernel walks little more of the
+ * directory than the entries returned, whatever its size. dir->resume is
+ * set to the offset just after the last entry and dir->more to whether
+ * any entry is left.
+ *
+ * @param fd   Directory descriptor.
+ * @param opts Listing options, paged.
+ * @param dir  Listing to fill.
+ * @return 0 on success, -1 on error (errno set).
+ */
+static int read_page_entries(int fd, const ls_opts_t *opts, ls_dir_t *dir) {
+  if (opts->cursor && lseek(fd, (off_t)opts->cursor->offset, SEEK_SET) < 0) {
+    return -1;
+  }
+  size_t want = LS_DENTS_BUFFER;
+  if (opts->limit > 0 && opts->limit < LS_DENTS_BUFFER / LS_DENT_MAX) {
+    want = (opts->limit + 1) * LS_DENT_MAX;
+  }
+
+  for (;;) {
+    ssize_t n = getdents64(fd, ls_dents_buffer, want);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    if (n == 0) return 0;
+
+    for (ssize_t off = 0; off < n; ) {
+      struct dirent64 *d = (struct dirent64 *)(ls_dents_buffer + off);
+      off += d->d_reclen;
+      if (!opts->show_all && d->d_name[0] == '.') continue;
+      if (opts->limit > 0 && dir->count == opts->limit) {
+        dir->more = 1;
+        return 0;
+      }
+      if (add_entry(dir, d->d_name, strlen(d->d_name), d->d_type) != 0) {
+        errno = ENOMEM;
+        return -1;
+      }
+      dir->resume = (unsigned long long)d->d_off;
+    }
+  }
+}
+
+/**
+ * Compares two entries by name, in byte order.
+ */
+static int compare_names(const void *a, const void *b, void *names) {
+  const ls_entry_t *x = a;
+  const ls_entry_t *y = b;
+  return strcmp((const char *)names + x->name, (const char *)names + y->name);
+}
+
+/**
+ * Compares two entries by size, largest first, then by name.
+ */
+static int compare_sizes(const void *a, const void *b, void *names) {
+  const ls_entry_t *x = a;
+  const ls_entry_t *y = b;
+  off_t xs = x->st ? x->st->st_size : 0;
+  off_t ys = y->st ? y->st->st_size : 0;
+  if (xs != ys) return xs < ys ? 1 : -1;
+  return compare_names(a, b, names);
+}
+
+/**
+ * Compares two entries by modification time, newest first, then by name.
+ */
+static int compare_times(const void *a, const void *b, void *names) {
+  const ls_entry_t *x = a;
+  const ls_entry_t *y = b;
+  struct timespec xt = x->st ? x->st->st_mtim : (struct timespec){ 0 };
+  struct timespec yt = y->st ? y->st->st_mtim : (struct timespec){ 0 };
+  if (xt.tv_sec != yt.tv_sec) return xt.tv_sec < yt.tv_sec ? 1 : -1;
+  if (xt.tv_nsec != yt.tv_nsec) return xt.tv_nsec < yt.tv_nsec ? 1 : -1;
+  return compare_names(a, b, names);
+}
+
+/**
+ * Picks the comparison for the selected sort order.
+ *
+ * @param opts Listing options.
+ * @return Comparison for qsort_r(), ignoring -r.
+ */
+static int (*entry_comparator(const ls_opts_t *opts))(const void *,
+                                                      const void *, void *) {
+  if (opts->sort == LS_SORT_SIZE) return compare_sizes;
+  if (opts->sort == LS_SORT_TIME) return compare_times;
+  return compare_names;
+}
+
+/**
+ * Sorts a listing in the selected order.
+ *
+ * @param dir  Listing to sort.
+ * @param opts Listing options.
+ */
+static void sort_entries(ls_dir_t *dir, const ls_opts_t *opts) {
+  int (*compare)(const void *, const void *, void *) = entry_comparator(opts);
+  if (opts->sort != LS_SORT_NONE && dir->count > 1) {
+    qsort_r(dir->entries, dir->count, sizeof(dir->entries[0]), compare,
+            dir->names);
+  }
+
+  if (opts->reverse) {
+    for (size_t i = 0, j = dir->count; i + 1 < j; i++, j--) {
+      ls_entry_t tmp = dir->entries[i];
+      dir->entries[i] = dir->entries[j - 1];
+      dir->entries[j - 1] = tmp;
+    }
+  }
+}
+
+/**
+ * Compares an entry with the last entry of the previous page, in the
+ * order the cursor was made under, ignoring -r.
+ *
+ * @param dir    Listing holding the entry.
+ * @param entry  Entry to compare.
+ * @param cursor Cursor of a sorted listing.
+ * @return Negative, zero or positive as the entry sorts before, as, or
+ *         after the cursor.
+ */
+static int compare_to_cursor(const ls_dir_t *dir, const ls_entry_t *entry,
+                             const ls_cursor_t *cursor) {
+  if (cursor->sort == LS_SORT_SIZE) {
+    off_t size = entry->st ? entry->st->st_size : 0;
+    if (size != cursor->size) return size < cursor->size ? 1 : -1;
+  } else if (cursor->sort == LS_SORT_TIME) {
+    struct timespec t = entry->st ? entry->st->st_mtim : (struct timespec){ 0 };
+    if (t.tv_sec != cursor->mtime.tv_sec) {
+      return t.tv_sec < cursor->mtime.tv_sec ? 1 : -1;
+    }
+    if (t.tv_nsec != cursor->mtime.tv_nsec) {
+      return t.tv_nsec < cursor->mtime.tv_nsec ? 1 : -1;
+    }
+  }
+  return strcmp(dir->names + entry->name, cursor->name);
+}
+
+/**
+ * Whether entry a is listed before entry b, -r included.
+ */
+static int listed_before(const ls_dir_t *dir, const ls_entry_t *a,
+                         const ls_entry_t *b, const ls_opts_t *opts) {
+  int order = entry_comparator(opts)(a, b, dir->names);
+  return opts->reverse ? order > 0 : order < 0;
+}
+
+/**
+ * Moves the entry at i down a heap whose root is the entry listed last.
+ */
+static void sift_down(ls_dir_t *dir, size_t i, size_t n,
+                      const ls_opts_t *opts) {
+  ls_entry_t *e = dir->entries;
+  for (;;) {
+    size_t last = i;
+    size_t l = 2 * i + 1;
+    size_t r = l + 1;
+    if (l < n && listed_before(dir, &e[last], &e[l], opts)) last = l;
+    if (r < n && listed_before(dir, &e[last], &e[r], opts)) last = r;
+    if (last == i) return;
+    ls_entry_t tmp = e[i];
+    e[i] = e[last];
+    e[last] = tmp;
+    i = last;
+  }
+}
+
+/**
+ * Cuts a sorted listing down to one page: the entries listed after the
+ * cursor, and of those the first opts->limit, left unsorted.
+ *
+ * The page is picked with a heap of opts->limit entries in one pass, so
+ * a small page of a huge directory costs neither a full sort nor, when
+ * ordering by name, a stat of every entry.
+ *
+ * @param dir  Listing to cut; dir->more is set if entries are dropped
+ *             after the page.
+ * @param opts Listing options, paged.
+ */
+static void select_page(ls_dir_t *dir, const ls_opts_t *opts) {
+  size_t kept = 0;
+  for (size_t i = 0; i < dir->count; i++) {
+    ls_entry_t *entry = &dir->entries[i];
+    if (opts->stat_mask && dir->stats && !entry->st) continue;
+    if (opts->cursor) {
+      int order = compare_to_cursor(dir, entry, opts->cursor);
+      if (opts->reverse ? order >= 0 : order <= 0) continue;
+    }
+    dir->entries[kept++] = *entry;
+  }
+  dir->count = kept;
+
+  size_t k = opts->limit;
+  if (k == 0 || dir->count <= k) return;
+  dir->more = 1;
+  for (size_t i = k / 2; i-- > 0; ) {
+    sift_down(dir, i, k, opts);
+  }
+  for (size_t i = k; i < dir->count; i++) {
+    if (listed_before(dir, &dir->entries[i], &dir->entries[0], opts)) {
+      dir->entries[0] = dir->entries[i];
+      sift_down(dir, 0, k, opts);
     }
+  }
+  dir->count = k;
+}
 
-    char fullpath[4096];
-    snprintf(fullpath, sizeof(fullpath), "%s/%s", path, entry->d_name);
+/**
+ * Stats a directory entry with statx(), asking only for the fields the
+ * output needs, and falls back to fstatat() where statx() is missing.
+ *
+ * @param fd   Directory descriptor.
+ * @param name Entry name.
+ * @param mask STATX_* fields wanted.
+ * @param st   Set to the fields that were asked for; the rest are zero.
+ * @return 0 on success, -1 on error (errno set).
+ */
+static int stat_entry_at(int fd, const char *name, unsigned int mask,
+                         struct stat *st) {
+  struct statx sx;
+  if (statx(fd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, mask, &sx) != 0) {
+    if (errno != ENOSYS) return -1;
+    return fstatat(fd, name, st, AT_SYMLINK_NOFOLLOW);
+  }
+
+  memset(st, 0, sizeof(*st));
+  st->st_dev = makedev(sx.stx_dev_major, sx.stx_dev_minor);
+  st->st_ino = sx.stx_ino;
+  st->st_mode = sx.stx_mode;
+  st->st_nlink = sx.stx_nlink;
+  st->st_uid = sx.stx_uid;
+  st->st_gid = sx.stx_gid;
+  st->st_rdev = makedev(sx.stx_rdev_major, sx.stx_rdev_minor);
+  st->st_size = sx.stx_size;
+  st->st_blksize = sx.stx_blksize;
+  st->st_blocks = sx.stx_blocks;
+  st->st_atim.tv_sec = sx.stx_atime.tv_sec;
+  st->st_atim.tv_nsec = sx.stx_atime.tv_nsec;
+  st->st_mtim.tv_sec = sx.stx_mtime.tv_sec;
+  st->st_mtim.tv_nsec = sx.stx_mtime.tv_nsec;
+  st->st_ctim.tv_sec = sx.stx_ctime.tv_sec;
+  st->st_ctim.tv_nsec = sx.stx_ctime.tv_nsec;
+  return 0;
+}
 
-    struct stat st;
-    if (lstat(fullpath, &st) == -1) {
-      if (!show_json) {
-        fprintf(stderr, "ls: cannot stat '%s': %s\n", fullpath, strerror(errno));
+/**
+ * Stats entries of the pool's current job until none are left unclaimed.
+ *
+ * @param pool Pool the job was posted to.
+ * @param fd   Directory descriptor.
+ * @param dir  Listing whose entries are stat'ed.
+ * @param mask STATX_* fields wanted.
+ */
+static void stat_claimed_entries(ls_stat_pool_t *pool, int fd, ls_dir_t *dir,
+                                 unsigned int mask) {
+  for (;;) {
+    size_t start = atomic_fetch_add(&pool->next, LS_STAT_CHUNK);
+    if (start >= dir->count) return;
+    size_t end = start + LS_STAT_CHUNK;
+    if (end > dir->count) end = dir->count;
+
+    for (size_t i = start; i < end; i++) {
+      ls_entry_t *entry = &dir->entries[i];
+      if (stat_entry_at(fd, dir->names + entry->name, mask,
+                        &dir->stats[i]) == 0) {
+        entry->st = &dir->stats[i];
+      } else {
+        entry->err = errno;
       }
-      continue;
     }
+  }
+}
+
+/**
+ * Stat worker: takes part in every job posted to the pool.
+ * @param arg The ls_stat_pool_t of the thread that started it.
+ * @return NULL
+ */
+static void *stat_worker(void *arg) {
+  ls_stat_pool_t *pool = arg;
+  unsigned long seen = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->stop && pool->job == seen) {
+      pthread_cond_wait(&pool->wake, &pool->lock);
+    }
+    if (pool->stop) break;
+    seen = pool->job;
+    int fd = pool->fd;
+    ls_dir_t *dir = pool->dir;
+    unsigned int mask = pool->mask;
+    pthread_mutex_unlock(&pool->lock);
+
+    stat_claimed_entries(pool, fd, dir, mask);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->active == 0) {
+      pthread_cond_signal(&pool->idle);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+/**
+ * Starts the stat workers the first time a large directory is seen.
+ *
+ * @return Number of workers running; 0 means stat on this thread alone.
+ */
+static int start_stat_pool(void) {
+  if (ls_pool.tried) return ls_pool.nthreads;
+  ls_pool.tried = 1;
+
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int wanted = cores > 1 ? (int)cores - 1 : 0;   /* This thread works too */
+  if (wanted > LS_MAX_WORKERS) wanted = LS_MAX_WORKERS;
+  for (int i = 0; i < wanted; i++) {
+    if (pthread_create(&ls_pool.threads[i], NULL, stat_worker,
+                       &ls_pool) != 0) {
+      break;
+    }
+    ls_pool.nthreads++;
+  }
+  return ls_pool.nthreads;
+}
+
+/**
+ * Stops and joins the stat workers, if any were started.
+ */
+static void stop_stat_pool(void) {
+  pthread_mutex_lock(&ls_pool.lock);
+  ls_pool.stop = 1;
+  pthread_cond_broadcast(&ls_pool.wake);
+  pthread_mutex_unlock(&ls_pool.lock);
+
+  for (int i = 0; i < ls_pool.nthreads; i++) {
+    pthread_join(ls_pool.threads[i], NULL);
+  }
+  ls_pool.nthreads = 0;
+  ls_pool.tried = 0;
+  ls_pool.stop = 0;
+}
+
+/**
+ * Stats every entry of a listing, spreading large directories across the
+ * stat workers.
+ *
+ * @param fd   Directory descriptor.
+ * @param dir  Listing with stats allocated.
+ * @param mask STATX_* fields wanted.
+ */
+static void stat_entries(int fd, ls_dir_t *dir, unsigned int mask) {
+  atomic_store(&ls_pool.next, 0);
+  if (dir->count < LS_STAT_PARALLEL_MIN || start_stat_pool() == 0) {
+    stat_claimed_entries(&ls_pool, fd, dir, mask);
+    return;
+  }
 
-    if (show_json) {
-      char escaped_name[512];
-      escape_json_string(entry->d_name, escaped_name, sizeof(escaped_name));
+  pthread_mutex_lock(&ls_pool.lock);
+  ls_pool.fd = fd;
+  ls_pool.dir = dir;
+  ls_pool.mask = mask;
+  ls_pool.active = ls_pool.nthreads;
+  ls_pool.job++;
+  pthread_cond_broadcast(&ls_pool.wake);
+  pthread_mutex_unlock(&ls_pool.lock);
 
-      if (!*first_entry) {
-        printf(",\n");
+  stat_claimed_entries(&ls_pool, fd, dir, mask);
+
+  pthread_mutex_lock(&ls_pool.lock);
+  while (ls_pool.active > 0) {
+    pthread_cond_wait(&ls_pool.idle, &ls_pool.lock);
+  }
+  pthread_mutex_unlock(&ls_pool.lock);
+}
+
+/**
+ * Reads, stats and sorts the entries of an open directory.
+ *
+ * Entries are only stat'ed when the output or the sort order needs more
+ * than their names; a recursive listing otherwise trusts d_type and only
+ * stats entries whose type the filesystem did not report. A paged listing
+ * keeps just the page.
+ *
+ * @param fd   Directory descriptor.
+ * @param path Directory path, for messages.
+ * @param opts Listing options.
+ * @param dir  Listing to fill; freed by free_directory().
+ * @return 0 on success, 1 on error.
+ */
+static int load_directory(int fd, const char *path, const ls_opts_t *opts,
+                          ls_dir_t *dir) {
+  int result = 0;
+  int unsorted_page = opts->paged && opts->sort == LS_SORT_NONE;
+  int name_page = opts->paged && opts->sort == LS_SORT_NAME;
+
+  if ((unsorted_page ? read_page_entries(fd, opts, dir)
+                     : read_entries(fd, opts->show_all, dir)) != 0) {
+    report_path_error("cannot read directory", path, errno, opts);
+    result = 1;
+  }
+  /* Names alone order the page: stat only the entries on it */
+  if (name_page) {
+    select_page(dir, opts);
+  }
+
+  if (opts->stat_mask && dir->count > 0) {
+    dir->stats = malloc(dir->count * sizeof(*dir->stats));
+    if (!dir->stats) {
+      fprintf(stderr, "ls: out of memory\n");
+      dir->count = 0;
+      return 1;
+    }
+    stat_entries(fd, dir, opts->stat_mask);
+
+    for (size_t i = 0; i < dir->count; i++) {
+      ls_entry_t *entry = &dir->entries[i];
+      if (entry->err && !opts->show_json) {
+        fprintf(stderr, "ls: cannot stat '%s/%s': %s\n", path,
+                dir->names + entry->name, strerror(entry->err));
+      }
+    }
+  } else if (opts->recursive) {
+    for (size_t i = 0; i < dir->count; i++) {
+      ls_entry_t *entry = &dir->entries[i];
+      struct stat st;
+      if (entry->type == DT_UNKNOWN &&
+          fstatat(fd, dir->names + entry->name, &st,
+                  AT_SYMLINK_NOFOLLOW) == 0) {
+        entry->type = IFTODT(st.st_mode);
       }
-      *first_entry = 0;
+    }
+  }
+
+  if (opts->paged && !unsorted_page && !name_page) {
+    select_page(dir, opts);
+  }
+  sort_entries(dir, opts);
+  return result;
+}
+
+/**
+ * Frees a listing.
+ *
+ * @param dir Listing to free.
+ */
+static void free_directory(ls_dir_t *dir) {
+  free(dir->stats);
+  free(dir->entries);
+  free(dir->names);
+}
+
+/**
+ * Whether a listed entry is a subdirectory to descend into.
+ *
+ * @param dir   Listing holding the entry.
+ * @param entry Entry to check.
+ * @return Non-zero for a real directory other than "." and "..".
+ */
+static int is_subdirectory(const ls_dir_t *dir, const ls_entry_t *entry) {
+  const char *name = dir->names + entry->name;
+  if (name[0] == '.' &&
+      (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+    return 0;
+  }
+  if (entry->st) return S_ISDIR(entry->st->st_mode);
+  return entry->type == DT_DIR;
+}
+
+/**
+ * Appends a name to a path, adding a '/' unless it already ends in one.
+ *
+ * @param path Path to extend.
+ * @param name Name to append.
+ * @return Length of the path before the append, to cut back to, or
+ *         (size_t)-1 if out of memory.
+ */
+static size_t push_path(ls_path_t *path, const char *name) {
+  size_t old_len = path->len;
+  size_t name_len = strlen(name);
+  int slash = path->len > 0 && path->buf[path->len - 1] != '/';
+  size_t need = path->len + slash + name_len + 1;
+  if (need > path->cap) {
+    size_t cap = path->cap ? path->cap * 2 : 256;
+    while (cap < need) cap *= 2;
+    char *buf = realloc(path->buf, cap);
+    if (!buf) return (size_t)-1;
+    path->buf = buf;
+    path->cap = cap;
+  }
+  if (slash) path->buf[path->len++] = '/';
+  memcpy(path->buf + path->len, name, name_len + 1);
+  path->len += name_len;
+  return old_len;
+}
+
+/**
+ * Cuts a path back to an earlier length.
+ *
+ * @param path Path to shorten.
+ * @param len  Length returned by push_path().
+ */
+static void pop_path(ls_path_t *path, size_t len) {
+  path->len = len;
+  path->buf[len] = '\0';
+}
+
+/**
+ * Makes the --cursor token for the page after a listing's last entry:
+ * the sort order, the directory's inode and the position, as hex fields.
+ *
+ * @param dir     Sorted page, with at least one entry.
+ * @param dir_ino Inode of the directory.
+ * @param opts    Listing options.
+ * @return Newly allocated token, or NULL if out of memory.
+ */
+static char *format_cursor(const ls_dir_t *dir, ino_t dir_ino,
+                           const ls_opts_t *opts) {
+  const ls_entry_t *last = &dir->entries[dir->count - 1];
+  const char *name = opts->sort == LS_SORT_NONE ? ""
+                                                : dir->names + last->name;
+  unsigned long long a = 0;
+  unsigned long long b = 0;
+  if (opts->sort == LS_SORT_NONE) {
+    a = dir->resume;
+  } else if (opts->sort == LS_SORT_SIZE && last->st) {
+    a = (unsigned long long)last->st->st_size;
+  } else if (opts->sort == LS_SORT_TIME && last->st) {
+    a = (unsigned long long)last->st->st_mtim.tv_sec;
+    b = (unsigned long long)last->st->st_mtim.tv_nsec;
+  }
 
-      printf("    {\"name\": \"%s\", \"type\": \"%s\", \"size\": %ld, \"mtime\": %ld",
-             escaped_name, get_file_type_string(st.st_mode),
-             (long)st.st_size, (long)st.st_mtime);
+  size_t len = strlen(name);
+  char *token = malloc(5 * 17 + 2 * len + 1);
+  if (!token) return NULL;
+  int n = sprintf(token, "%x.%x.%llx.%llx.%llx.", opts->sort, opts->reverse,
+                  (unsigned long long)dir_ino, a, b);
+  for (size_t i = 0; i < len; i++) {
+    n += sprintf(token + n, "%02x", (unsigned char)name[i]);
+  }
+  return token;
+}
 
-      if (show_long) {
-        char perms[12];
-        format_permissions(st.st_mode, perms);
+/**
+ * Reads a --cursor token made by format_cursor().
+ *
+ * @param text   Token.
+ * @param cursor Set to the position; cursor->name is allocated.
+ * @return 0 on success, -1 if text is not a token (or out of memory).
+ */
+static int parse_cursor(const char *text, ls_cursor_t *cursor) {
+  unsigned long long fields[5];
+  const char *p = text;
+  for (int i = 0; i < 5; i++) {
+    char *end;
+    errno = 0;
+    fields[i] = strtoull(p, &end, 16);
+    if (errno != 0 || end == p || *end != '.' || *p == '-') return -1;
+    p = end + 1;
+  }
+  size_t hex_len = strlen(p);
+  if (hex_len % 2 != 0 || fields[0] > LS_SORT_NONE || fields[1] > 1) {
+    return -1;
+  }
 
-        struct passwd *pw = getpwuid(st.st_uid);
-        struct group *gr = getgrgid(st.st_gid);
+  char *name = malloc(hex_len / 2 + 1);
+  if (!name) return -1;
+  for (size_t i = 0; i < hex_len / 2; i++) {
+    unsigned int byte;
+    if (sscanf(p + 2 * i, "%2x", &byte) != 1 || byte == 0 || byte == '/') {
+      free(name);
+      return -1;
+    }
+    name[i] = (char)byte;
+  }
+  name[hex_len / 2] = '\0';
 
-        printf(", \"mode\": \"%s\", \"nlink\": %ld, \"owner\": \"%s\", \"group\": \"%s\"",
-               perms, (long)st.st_nlink,
-               pw ? pw->pw_name : "unknown",
-               gr ? gr->gr_name : "unknown");
+  cursor->sort = (int)fields[0];
+  cursor->reverse = (int)fields[1];
+  cursor->dir_ino = fields[2];
+  cursor->offset = fields[3];
+  cursor->size = (off_t)fields[3];
+  cursor->mtime.tv_sec = (time_t)fields[3];
+  cursor->mtime.tv_nsec = (long)fields[4];
+  cursor->name = name;
+  return 0;
+}
+
+/**
+ * Prints the cursor to pass as --cursor for the next page: as the last
+ * element of the --json array, as a last object under --json-stream, or
+ * on stderr under text output, which has nowhere else to put it.
+ *
+ * @param token       Cursor token.
+ * @param opts        Listing options.
+ * @param first_entry Pointer to flag tracking if this is the first JSON entry.
+ */
+static void print_next_cursor(const char *token, const ls_opts_t *opts,
+                              int *first_entry) {
+  if (opts->record) {
+    jbox_record_clear(opts->record);
+    jbox_record_add_string(opts->record, "cursor", token);
+    jbox_record_write(jbox_stdout(), opts->record, true);
+  } else if (opts->show_json) {
+    if (!opts->json_stream) begin_json_element(0, first_entry);
+    fputs("{\"cursor\": ", jbox_stdout());
+    jbox_json_write_string(jbox_stdout(), token);
+    fputs(opts->json_stream ? "}\n" : "}", jbox_stdout());
+  } else {
+    fflush(jbox_stdout());
+    fprintf(stderr, "ls: more entries follow; continue with --cursor %s\n",
+            token);
+  }
+}
+
+/**
+ * Lists an open directory and, with -R, everything below it.
+ *
+ * Text and --json-stream output print a directory whole before its
+ * subdirectories, as ls -R does; --json nests each subdirectory's
+ * entries under "children" in its own entry.
+ *
+ * @param fd          Directory descriptor; closed before returning.
+ * @param path        Path of the directory.
+ * @param depth       Levels below the PATH argument.
+ * @param opts        Listing options.
+ * @param first_entry Pointer to flag tracking if this is the first entry
+ *                    of the current JSON array.
+ * @return 0 on success, 1 if anything could not be listed.
+ */
+static int list_tree(int fd, ls_path_t *path, int depth, const ls_opts_t *opts,
+                     int *first_entry) {
+  ls_dir_t dir = { 0 };
+  int result = load_directory(fd, path->buf, opts, &dir);
+  int descend = opts->recursive &&
+                (opts->max_depth < 0 || depth < opts->max_depth);
+  int nested = opts->show_json && !opts->json_stream;
+
+  for (size_t i = 0; i < dir.count; i++) {
+    ls_entry_t *entry = &dir.entries[i];
+    const char *name = dir.names + entry->name;
+    if (opts->stat_mask && !entry->st) continue;
+
+    if (!(nested && descend && is_subdirectory(&dir, entry))) {
+      print_entry(name, path->buf, entry->st, opts, depth, first_entry);
+      continue;
+    }
+
+    begin_json_element(depth, first_entry);
+    print_json_fields(name, path->buf, entry->st, opts);
+    int child_fd = openat(fd, name,
+                          O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    size_t saved = child_fd >= 0 ? push_path(path, name) : (size_t)-1;
+    if (saved == (size_t)-1) {
+      fputs(", \"error\": ", jbox_stdout());
+      jbox_json_write_string(jbox_stdout(),
+                             strerror(child_fd >= 0 ? ENOMEM : errno));
+      fputs("}", jbox_stdout());
+      if (child_fd >= 0) close(child_fd);
+      result = 1;
+      continue;
+    }
+    int child_first = 1;
+    fputs(", \"children\": [\n", jbox_stdout());
+    result |= list_tree(child_fd, path, depth + 1, opts, &child_first);
+    pop_path(path, saved);
+    if (!child_first) {
+      jbox_printf("\n%*s", 4 + 4 * depth, "");
+    }
+    fputs("]}", jbox_stdout());
+  }
+
+  if (descend && !nested) {
+    for (size_t i = 0; i < dir.count; i++) {
+      ls_entry_t *entry = &dir.entries[i];
+      if (opts->stat_mask && !entry->st) continue;
+      if (!is_subdirectory(&dir, entry)) continue;
+
+      size_t saved = push_path(path, dir.names + entry->name);
+      if (saved == (size_t)-1) {
+        fprintf(stderr, "ls: out of memory\n");
+        result = 1;
+        break;
+      }
+      if (!opts->show_json) {
+        jbox_printf("\n%s:\n", path->buf);
+      }
+      int child_fd = openat(fd, dir.names + entry->name,
+                            O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+      if (child_fd < 0) {
+        report_path_error("cannot open directory", path->buf, errno, opts);
+        result = 1;
+      } else {
+        result |= list_tree(child_fd, path, depth + 1, opts, first_entry);
       }
-      printf("}");
-    } else if (show_long) {
-      char perms[12];
-      format_permissions(st.st_mode, perms);
-
-      struct passwd *pw = getpwuid(st.st_uid);
-      struct group *gr = getgrgid(st.st_gid);
-
-      char timebuf[64];
-      struct tm *tm = localtime(&st.st_mtime);
-      strftime(timebuf, sizeof(timebuf), "%b %d %H:%M", tm);
-
-      printf("%s %3ld %-8s %-8s %8ld %s %s\n",
-             perms, (long)st.st_nlink,
-             pw ? pw->pw_name : "unknown",
-             gr ? gr->gr_name : "unknown",
-             (long)st.st_size, timebuf, entry->d_name);
+      pop_path(path, saved);
+    }
+  }
+
+  struct stat dir_st;
+  if (opts->paged && dir.more && dir.count > 0 && fstat(fd, &dir_st) == 0) {
+    char *token = format_cursor(&dir, dir_st.st_ino, opts);
+    if (token) {
+      print_next_cursor(token, opts, first_entry);
+      free(token);
     } else {
-      printf("%s\n", entry->d_name);
+      fprintf(stderr, "ls: out of memory\n");
+      result = 1;
     }
   }
 
-  closedir(dir);
-  return 0;
+  free_directory(&dir);
+  close(fd);
+  return result;
+}
+
+/**
+ * Lists a directory given on the command line.
+ *
+ * @param path_arg    Path to the directory to list.
+ * @param opts        Listing options.
+ * @param first_entry Pointer to flag tracking if this is the first JSON entry.
+ * @return 0 on success, 1 on error.
+ */
+static int list_directory(const char *path_arg, const ls_opts_t *opts,
+                          int *first_entry) {
+  int fd = openat(jbox_cwd_fd(), path_arg,
+                  O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    report_path_error("cannot access", path_arg, errno, opts);
+    return 1;
+  }
+  struct stat st;
+  if (opts->cursor && fstat(fd, &st) == 0
+      && (unsigned long long)st.st_ino != opts->cursor->dir_ino) {
+    fprintf(stderr, "ls: cursor is for a different directory than '%s'\n",
+            path_arg);
+    close(fd);
+    return 1;
+  }
+
+  ls_path_t path = { 0 };
+  if (push_path(&path, path_arg) == (size_t)-1) {
+    fprintf(stderr, "ls: out of memory\n");
+    close(fd);
+    return 1;
+  }
+  int result = list_tree(fd, &path, 0, opts, first_entry);
+  free(path.buf);
+  return result;
 }
 
 /**
@@ -263,7 +1433,7 @@ static int ls_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    ls_print_usage(stdout);
+    ls_print_usage(jbox_stdout());
     cleanup_ls_argtable(&args);
     return 0;
   }
@@ -275,94 +1445,173 @@ static int ls_run(int argc, char **argv) {
     return 1;
   }
 
-  int show_all = args.all->count > 0;
-  int show_long = args.longfmt->count > 0;
-  int show_json = args.json->count > 0;
+  ls_opts_t opts = {
+    .show_all = args.all->count > 0,
+    .show_long = args.longfmt->count > 0,
+    .show_json = args.json->count > 0 || args.json_stream->count > 0,
+    .json_stream = args.json_stream->count > 0,
+    .sort = LS_SORT_NAME,
+    .reverse = args.reverse->count > 0,
+    .recursive = args.recursive->count > 0 || args.max_depth->count > 0,
+    .max_depth = -1
+  };
+
+  if (args.max_depth->count > 0) {
+    if (args.max_depth->ival[0] < 0) {
+      fprintf(stderr, "ls: invalid maximum depth '%d'\n",
+              args.max_depth->ival[0]);
+      cleanup_ls_argtable(&args);
+      return 1;
+    }
+    opts.max_depth = args.max_depth->ival[0];
+  }
+
+  if (args.by_size->count > 0) {
+    opts.sort = LS_SORT_SIZE;
+  } else if (args.by_time->count > 0) {
+    opts.sort = LS_SORT_TIME;
+  } else if (args.unsorted->count > 0) {
+    opts.sort = LS_SORT_NONE;
+  }
+  if (args.sort->count > 0) {
+    const char *word = args.sort->sval[0];
+    if (strcmp(word, "name") == 0) {
+      opts.sort = LS_SORT_NAME;
+    } else if (strcmp(word, "size") == 0) {
+      opts.sort = LS_SORT_SIZE;
+    } else if (strcmp(word, "time") == 0) {
+      opts.sort = LS_SORT_TIME;
+    } else if (strcmp(word, "none") == 0) {
+      opts.sort = LS_SORT_NONE;
+    } else {
+      fprintf(stderr, "ls: invalid argument '%s' for '--sort'\n", word);
+      fprintf(stderr, "Valid arguments are: name, size, time, none\n");
+      cleanup_ls_argtable(&args);
+      return 1;
+    }
+  }
+
+  /* A page is of one directory; its cursor must be from the same order */
+  ls_cursor_t cursor = { 0 };
+  opts.paged = args.limit->count > 0 || args.cursor->count > 0;
+  if (args.limit->count > 0) {
+    if (args.limit->ival[0] < 1) {
+      fprintf(stderr, "ls: invalid limit '%d'\n", args.limit->ival[0]);
+      cleanup_ls_argtable(&args);
+      return 1;
+    }
+    opts.limit = (size_t)args.limit->ival[0];
+  }
+  if (opts.paged && (opts.recursive || args.paths->count > 1)) {
+    fprintf(stderr, "ls: --limit and --cursor list one directory, "
+                    "without -R\n");
+    cleanup_ls_argtable(&args);
+    return 1;
+  }
+  if (opts.paged && opts.sort == LS_SORT_NONE && opts.reverse) {
+    fprintf(stderr, "ls: -r cannot be used to page in directory order\n");
+    cleanup_ls_argtable(&args);
+    return 1;
+  }
+  if (args.cursor->count > 0) {
+    const char *token = args.cursor->sval[0];
+    if (parse_cursor(token, &cursor) != 0) {
+      fprintf(stderr, "ls: invalid cursor '%s'\n", token);
+      cleanup_ls_argtable(&args);
+      return 1;
+    }
+    if (cursor.sort != opts.sort || cursor.reverse != opts.reverse) {
+      fprintf(stderr, "ls: cursor '%s' is for a different sort order\n",
+              token);
+      free(cursor.name);
+      cleanup_ls_argtable(&args);
+      return 1;
+    }
+    opts.cursor = &cursor;
+  }
+
+  if (opts.show_long) {
+    opts.stat_mask |= STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_UID |
+                      STATX_GID | STATX_SIZE | STATX_MTIME;
+  }
+  if (opts.show_json) {
+    opts.stat_mask |= STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME;
+  }
+  if (opts.sort == LS_SORT_SIZE) {
+    opts.stat_mask |= STATX_TYPE | STATX_MODE | STATX_SIZE;
+  } else if (opts.sort == LS_SORT_TIME) {
+    opts.stat_mask |= STATX_TYPE | STATX_MODE | STATX_MTIME;
+  }
+
+  ls_dents_buffer = jbox_alloc(LS_DENTS_BUFFER);
+  if (!ls_dents_buffer) {
+    fprintf(stderr, "ls: %s\n", strerror(ENOMEM));
+    cleanup_ls_argtable(&args);
+    return 1;
+  }
+  /* A host owns its stream's buffering, and this buffer is shared */
+  if (!jbox_ctx_is_hosted()) {
+    setvbuf(jbox_stdout(), ls_out_buffer, _IOFBF, sizeof(ls_out_buffer));
+  }
+  tzset();
+
+  jbox_record_t record;
+  jbox_record_init(&record);
+  if (opts.json_stream && jbox_stdout_takes_records()) {
+    opts.record = &record;
+  }
 
   int first_entry = 1;
   int result = 0;
 
-  if (show_json) {
-    printf("[\n");
+  if (opts.show_json && !opts.json_stream) {
+    jbox_printf("[\n");
   }
 
   if (args.paths->count == 0) {
-    result = list_directory(".", show_all, show_long, show_json, &first_entry);
+    if (opts.recursive && !opts.show_json) {
+      jbox_printf(".:\n");
+    }
+    result = list_directory(".", &opts, &first_entry);
   } else {
     for (int i = 0; i < args.paths->count; i++) {
+      const char *path = args.paths->filename[i];
       struct stat st;
-      if (lstat(args.paths->filename[i], &st) == -1) {
-        if (!show_json) {
-          fprintf(stderr, "ls: cannot access '%s': %s\n", args.paths->filename[i], strerror(errno));
-        }
+      if (fstatat(jbox_cwd_fd(), path, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+        report_path_error("cannot access", path, errno, &opts);
         result = 1;
         continue;
       }
 
       if (S_ISDIR(st.st_mode)) {
-        if (args.paths->count > 1 && !show_json) {
-          printf("%s:\n", args.paths->filename[i]);
+        if ((args.paths->count > 1 || opts.recursive) && !opts.show_json) {
+          jbox_printf("%s:\n", path);
         }
-        if (list_directory(args.paths->filename[i], show_all, show_long, show_json, &first_entry) != 0) {
+        if (list_directory(path, &opts, &first_entry) != 0) {
           result = 1;
         }
-        if (args.paths->count > 1 && i < args.paths->count - 1 && !show_json) {
-          printf("\n");
+        if (args.paths->count > 1 && i < args.paths->count - 1
+            && !opts.show_json) {
+          jbox_printf("\n");
         }
       } else {
-        if (show_json) {
-          char escaped_name[512];
-          escape_json_string(args.paths->filename[i], escaped_name, sizeof(escaped_name));
-
-          if (!first_entry) {
-            printf(",\n");
-          }
-          first_entry = 0;
-
-          printf("    {\"name\": \"%s\", \"type\": \"%s\", \"size\": %ld, \"mtime\": %ld",
-                 escaped_name, get_file_type_string(st.st_mode),
-                 (long)st.st_size, (long)st.st_mtime);
-
-          if (show_long) {
-            char perms[12];
-            format_permissions(st.st_mode, perms);
-
-            struct passwd *pw = getpwuid(st.st_uid);
-            struct group *gr = getgrgid(st.st_gid);
-
-            printf(", \"mode\": \"%s\", \"nlink\": %ld, \"owner\": \"%s\", \"group\": \"%s\"",
-                   perms, (long)st.st_nlink,
-                   pw ? pw->pw_name : "unknown",
-                   gr ? gr->gr_name : "unknown");
-          }
-          printf("}");
-        } else if (show_long) {
-          char perms[12];
-          format_permissions(st.st_mode, perms);
-
-          struct passwd *pw = getpwuid(st.st_uid);
-          struct group *gr = getgrgid(st.st_gid);
-
-          char timebuf[64];
-          struct tm *tm = localtime(&st.st_mtime);
-          strftime(timebuf, sizeof(timebuf), "%b %d %H:%M", tm);
-
-          printf("%s %3ld %-8s %-8s %8ld %s %s\n",
-                 perms, (long)st.st_nlink,
-                 pw ? pw->pw_name : "unknown",
-                 gr ? gr->gr_name : "unknown",
-                 (long)st.st_size, timebuf, args.paths->filename[i]);
-        } else {
-          printf("%s\n", args.paths->filename[i]);
-        }
+        print_entry(path, NULL, &st, &opts, 0, &first_entry);
       }
     }
   }
 
-  if (show_json) {
-    printf("\n]\n");
+  if (opts.show_json && !opts.json_stream) {
+    jbox_printf("\n]\n");
   }
 
+  fflush(jbox_stdout());
+  jbox_record_free(&record);
+  free(cursor.name);
+  stop_stat_pool();
+  free_id_cache(&ls_users);
+  free_id_cache(&ls_groups);
+  jbox_release(ls_dents_buffer);
+  ls_dents_buffer = NULL;
   cleanup_ls_argtable(&args);
   return result;
 }
@@ -373,11 +1622,18 @@ static int ls_run(int argc, char **argv) {
 const jshell_cmd_spec_t cmd_ls_spec = {
   .name = "ls",
   .summary = "list directory contents",
-  .long_help = "List information about the FILEs (the current directory by default).\n"
-               "Entries are sorted alphabetically.",
+  .long_help = "List information about the FILEs (the current directory "
+               "by default).\n"
+               "Entries are sorted by name unless -S, -t, -U or --sort is "
+               "given.\n"
+               "With -R, subdirectories are listed too, down to --max-depth "
+               "levels.\n"
+               "--limit N lists N entries and a --cursor to resume from.",
   .type = CMD_EXTERNAL,
   .run = ls_run,
-  .print_usage = ls_print_usage
+  .print_usage = ls_print_usage,
+  .describe_args = ls_describe_args,
+  .cache_scope = ls_cache_scope
 };
 
 
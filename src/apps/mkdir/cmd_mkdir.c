@@ -2,15 +2,20 @@
  *  @brief Implementation of the mkdir command for creating directories.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_ctx.h"
+#include "utils/jbox_dircache.h"
 
 
 /**
@@ -20,9 +25,10 @@ typedef struct {
   struct arg_lit *help;
   struct arg_lit *parents;
   struct arg_lit *json;
+  struct arg_lit *stdin0;
   struct arg_file *dirs;
   struct arg_end *end;
-  void *argtable[5];
+  void *argtable[6];
 } mkdir_args_t;
 
 
@@ -34,14 +40,18 @@ static void build_mkdir_argtable(mkdir_args_t *args) {
   args->help    = arg_lit0("h", "help", "display this help and exit");
   args->parents = arg_lit0("p", "parents", "make parent directories as needed");
   args->json    = arg_lit0(NULL, "json", "output in JSON format");
-  args->dirs    = arg_filen(NULL, NULL, "DIR", 1, 100, "directories to create");
+  args->stdin0  = arg_lit0(NULL, "stdin0", "also read NUL-separated "
+                           "directories from stdin");
+  args->dirs    = arg_filen(NULL, NULL, "DIR", 0, 100000,
+                            "directories to create");
   args->end     = arg_end(20);
 
   args->argtable[0] = args->help;
   args->argtable[1] = args->parents;
   args->argtable[2] = args->json;
-  args->argtable[3] = args->dirs;
-  args->argtable[4] = args->end;
+  args->argtable[3] = args->stdin0;
+  args->argtable[4] = args->dirs;
+  args->argtable[5] = args->end;
 }
 
 
@@ -71,6 +81,22 @@ static void mkdir_print_usage(FILE *out) {
 }
 
 
+/**
+ * @brief Passes the mkdir argtable to visit, for tool
+ *        schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void mkdir_describe_args(jshell_argtable_visit_fn visit,
+                                void *userdata) {
+  mkdir_args_t args;
+  build_mkdir_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_mkdir_argtable(&args);
+}
+
+
 /**
  * @brief Escapes special characters in a string for JSON output.
  * @param str Input string to escape.
@@ -105,63 +131,29 @@ static void escape_json_string(const char *str, char *out, size_t out_size) {
 }
 
 
-/**
- * @brief Creates a directory path with all parent directories as needed.
- * @param path Directory path to create.
- * @param mode Permissions mode for created directories.
- * @return 0 on success, -1 on failure.
- */
-static int mkdir_parents(const char *path, mode_t mode) {
-  char *path_copy = strdup(path);
-  if (!path_copy) {
-    return -1;
-  }
-
-  char *p = path_copy;
-  if (*p == '/') {
-    p++;
-  }
-
-  while (*p) {
-    while (*p && *p != '/') {
-      p++;
-    }
-
-    char saved = *p;
-    *p = '\0';
-
-    if (mkdir(path_copy, mode) != 0 && errno != EEXIST) {
-      free(path_copy);
-      return -1;
-    }
-
-    *p = saved;
-    if (*p) {
-      p++;
-    }
-  }
-
-  free(path_copy);
-  return 0;
-}
-
-
 /**
  * @brief Creates a single directory and outputs result.
+ *
+ * Leading directories are resolved through the cache, so paths sharing
+ * parents cost one mkdirat() each rather than a walk from the root.
+ *
+ * @param cache Directory cache shared by all paths.
  * @param path Directory path to create.
  * @param parents If non-zero, create parent directories as needed.
  * @param show_json If non-zero, output in JSON format.
  * @param first_entry Pointer to flag tracking first JSON entry.
  * @return 0 on success, non-zero on failure.
  */
-static int make_dir(const char *path, int parents, int show_json,
-                    int *first_entry) {
+static int make_dir(jbox_dircache_t *cache, const char *path, int parents,
+                    int show_json, int *first_entry) {
   int result;
 
   if (parents) {
-    result = mkdir_parents(path, 0755);
+    result = jbox_dircache_open(cache, path, 1, 0755) == -1 ? -1 : 0;
   } else {
-    result = mkdir(path, 0755);
+    const char *leaf;
+    int dirfd = jbox_dircache_parent(cache, path, 0, 0755, &leaf);
+    result = dirfd == -1 ? -1 : mkdirat(dirfd, leaf, 0755);
   }
 
   if (show_json) {
@@ -169,18 +161,18 @@ static int make_dir(const char *path, int parents, int show_json,
     escape_json_string(path, escaped_path, sizeof(escaped_path));
 
     if (!*first_entry) {
-      printf(",\n");
+      jbox_printf(",\n");
     }
     *first_entry = 0;
 
     if (result == 0) {
-      printf("{\"path\": \"%s\", \"status\": \"ok\"}", escaped_path);
+      jbox_printf("{\"path\": \"%s\", \"status\": \"ok\"}", escaped_path);
     } else {
       char escaped_error[256];
       escape_json_string(strerror(errno), escaped_error,
                          sizeof(escaped_error));
-      printf("{\"path\": \"%s\", \"status\": \"error\", \"message\": \"%s\"}",
-             escaped_path, escaped_error);
+      jbox_printf("{\"path\": \"%s\", \"status\": \"error\", "
+                  "\"message\": \"%s\"}", escaped_path, escaped_error);
     }
   } else {
     if (result != 0) {
@@ -206,7 +198,7 @@ static int mkdir_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    mkdir_print_usage(stdout);
+    mkdir_print_usage(jbox_stdout());
     cleanup_mkdir_argtable(&args);
     return 0;
   }
@@ -220,24 +212,55 @@ static int mkdir_run(int argc, char **argv) {
 
   int parents = args.parents->count > 0;
   int show_json = args.json->count > 0;
+  int from_stdin = args.stdin0->count > 0;
   int first_entry = 1;
   int result = 0;
 
+  if (args.dirs->count == 0 && !from_stdin) {
+    fprintf(stderr, "mkdir: missing operand\n");
+    fprintf(stderr, "Try 'mkdir --help' for more information.\n");
+    cleanup_mkdir_argtable(&args);
+    return 1;
+  }
+
+  jbox_dircache_t *cache = jbox_dircache_new();
+  if (!cache) {
+    fprintf(stderr, "mkdir: out of memory\n");
+    cleanup_mkdir_argtable(&args);
+    return 1;
+  }
+
   if (show_json) {
-    printf("[\n");
+    jbox_printf("[\n");
   }
 
   for (int i = 0; i < args.dirs->count; i++) {
-    if (make_dir(args.dirs->filename[i], parents, show_json,
+    if (make_dir(cache, args.dirs->filename[i], parents, show_json,
                  &first_entry) != 0) {
       result = 1;
     }
   }
 
+  if (from_stdin) {
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getdelim(&line, &cap, '\0', jbox_stdin())) > 0) {
+      if (line[len - 1] == '\0') len--;
+      if (len == 0) continue;
+      line[len] = '\0';
+      if (make_dir(cache, line, parents, show_json, &first_entry) != 0) {
+        result = 1;
+      }
+    }
+    free(line);
+  }
+
   if (show_json) {
-    printf("\n]\n");
+    jbox_printf("\n]\n");
   }
 
+  jbox_dircache_free(cache);
   cleanup_mkdir_argtable(&args);
   return result;
 }
@@ -250,10 +273,13 @@ const jshell_cmd_spec_t cmd_mkdir_spec = {
   .name = "mkdir",
   .summary = "make directories",
   .long_help = "Create the DIRECTORY(ies), if they do not already exist. "
-               "With -p, create parent directories as needed.",
+               "With -p, create parent directories as needed. With "
+               "--stdin0, NUL-separated directories are also read from "
+               "stdin.",
   .type = CMD_EXTERNAL,
   .run = mkdir_run,
-  .print_usage = mkdir_print_usage
+  .print_usage = mkdir_print_usage,
+  .describe_args = mkdir_describe_args
 };
 
 
@@ -2,16 +2,26 @@
  *  @brief Implementation of the mv command for moving/renaming files.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <libgen.h>
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_ctx.h"
+#include "utils/jbox_signals.h"
+#include "utils/jbox_copy.h"
+#include "utils/jbox_remove.h"
+
+/** move_entry() result: the copy is in place but the source remains */
+#define MV_SOURCE_KEPT (-3)
 
 
 /**
@@ -75,6 +85,21 @@ static void mv_print_usage(FILE *out) {
 }
 
 
+/**
+ * @brief Passes the mv argtable to visit, for tool
+ *        schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void mv_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  mv_args_t args;
+  build_mv_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_mv_argtable(&args);
+}
+
+
 /**
  * @brief Escapes special characters in a string for JSON output.
  * @param str Input string to escape.
@@ -163,6 +188,140 @@ static char *build_dest_path(const char *src, const char *dest) {
 }
 
 
+/**
+ * @brief Renames without replacing an existing destination unless forced.
+ * @param src Source path.
+ * @param dest Destination path.
+ * @param force If non-zero, an existing destination is replaced.
+ * @return 0 on success, -1 on error with errno set.
+ */
+static int rename_into_place(const char *src, const char *dest, int force) {
+  if (force) {
+    return rename(src, dest);
+  }
+  if (renameat2(AT_FDCWD, src, AT_FDCWD, dest, RENAME_NOREPLACE) == 0) {
+    return 0;
+  }
+  if (errno != EINVAL && errno != ENOSYS) {
+    return -1;
+  }
+  /* Filesystem without RENAME_NOREPLACE: check, then rename */
+  struct stat st;
+  if (lstat(dest, &st) == 0) {
+    errno = EEXIST;
+    return -1;
+  }
+  return rename(src, dest);
+}
+
+
+/**
+ * @brief Flushes a new directory entry by syncing the directory holding it.
+ * @param path Path whose parent directory is synced.
+ */
+static void sync_parent(const char *path) {
+  char *copy = strdup(path);
+  if (!copy) {
+    return;
+  }
+  int fd = open(dirname(copy), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+  free(copy);
+}
+
+
+/**
+ * @brief Moves SOURCE to a destination on another filesystem.
+ *
+ * The source is copied next to the destination under a hidden temporary
+ * name with the shared copy engine (reflinks, in-kernel copies and a
+ * thread pool for trees) and flushed to disk. Only then is it renamed
+ * into place, so the destination never holds a partial copy, and the
+ * source is removed.
+ *
+ * @param src Source path.
+ * @param dest Final destination path.
+ * @param force If non-zero, an existing destination is replaced.
+ * @return 0 on success, -1 on error (errno set, source untouched), -2 if
+ *         interrupted, MV_SOURCE_KEPT if the source could not be removed.
+ */
+static int move_across_devices(const char *src, const char *dest,
+                               int force) {
+  struct stat st;
+  if (lstat(src, &st) != 0) {
+    return -1;
+  }
+
+  char *dir_copy = strdup(dest);
+  char *base_copy = strdup(dest);
+  if (!dir_copy || !base_copy) {
+    free(dir_copy);
+    free(base_copy);
+    errno = ENOMEM;
+    return -1;
+  }
+  size_t len = strlen(dest) + 64;
+  char *tmp = malloc(len);
+  if (!tmp) {
+    free(dir_copy);
+    free(base_copy);
+    errno = ENOMEM;
+    return -1;
+  }
+  snprintf(tmp, len, "%s/.%s.mv-%ld", dirname(dir_copy), basename(base_copy),
+           (long)getpid());
+  free(dir_copy);
+  free(base_copy);
+
+  int flags = JBOX_COPY_NOFOLLOW | JBOX_COPY_SYNC;
+  int result = S_ISDIR(st.st_mode) ? jbox_copy_tree(src, tmp, flags, NULL)
+                                   : jbox_copy_file(src, tmp, flags);
+  if (result == 0 && rename_into_place(tmp, dest, force) != 0) {
+    result = -1;
+  }
+  if (result != 0) {
+    int saved_errno = errno;
+    jbox_remove_tree(tmp);
+    free(tmp);
+    errno = saved_errno;
+    return result;
+  }
+  free(tmp);
+
+  sync_parent(dest);
+  if (jbox_remove_tree(src) != 0) {
+    return MV_SOURCE_KEPT;
+  }
+  return 0;
+}
+
+
+/**
+ * @brief Moves SOURCE to the destination path.
+ *
+ * A rename when both are on one filesystem; otherwise a copy followed by
+ * removal of the source.
+ *
+ * @param src Source path.
+ * @param dest Final destination path.
+ * @param force If non-zero, an existing destination is replaced.
+ * @return 0 on success, -1 on error with errno set, -2 if interrupted,
+ *         MV_SOURCE_KEPT if the source could not be removed after copying.
+ */
+static int move_entry(const char *src, const char *dest, int force) {
+  if (rename_into_place(src, dest, force) == 0) {
+    return 0;
+  }
+  if (errno != EXDEV) {
+    return -1;
+  }
+  return move_across_devices(src, dest, force);
+}
+
+
 /**
  * @brief Main entry point for the mv command.
  * @param argc Argument count.
@@ -173,10 +332,13 @@ static int mv_run(int argc, char **argv) {
   mv_args_t args;
   build_mv_argtable(&args);
 
+  /* Set up signal handler for clean interrupt */
+  jbox_setup_sigint_handler();
+
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    mv_print_usage(stdout);
+    mv_print_usage(jbox_stdout());
     cleanup_mv_argtable(&args);
     return 0;
   }
@@ -197,8 +359,9 @@ static int mv_run(int argc, char **argv) {
     if (show_json) {
       char escaped_source[512];
       escape_json_string(source, escaped_source, sizeof(escaped_source));
-      printf("{\"status\": \"error\", \"source\": \"%s\", "
-             "\"message\": \"No such file or directory\"}\n", escaped_source);
+      jbox_printf("{\"status\": \"error\", \"source\": \"%s\", "
+                  "\"message\": \"No such file or directory\"}\n",
+                  escaped_source);
     } else {
       fprintf(stderr, "mv: cannot stat '%s': No such file or directory\n",
               source);
@@ -210,8 +373,8 @@ static int mv_run(int argc, char **argv) {
   char *final_dest = build_dest_path(source, dest);
   if (!final_dest) {
     if (show_json) {
-      printf("{\"status\": \"error\", \"message\": \"memory allocation "
-             "failed\"}\n");
+      jbox_printf("{\"status\": \"error\", \"message\": \"memory allocation "
+                  "failed\"}\n");
     } else {
       fprintf(stderr, "mv: memory allocation failed\n");
     }
@@ -223,9 +386,9 @@ static int mv_run(int argc, char **argv) {
     if (show_json) {
       char escaped_dest[512];
       escape_json_string(final_dest, escaped_dest, sizeof(escaped_dest));
-      printf("{\"status\": \"error\", \"dest\": \"%s\", "
-             "\"message\": \"File exists (use -f to overwrite)\"}\n",
-             escaped_dest);
+      jbox_printf("{\"status\": \"error\", \"dest\": \"%s\", "
+                  "\"message\": \"File exists (use -f to overwrite)\"}\n",
+                  escaped_dest);
     } else {
       fprintf(stderr, "mv: '%s' already exists (use -f to overwrite)\n",
               final_dest);
@@ -235,29 +398,55 @@ static int mv_run(int argc, char **argv) {
     return 1;
   }
 
-  int result = rename(source, final_dest);
+  int result = move_entry(source, final_dest, force);
+
+  /* Check for interruption */
+  if (result == -2) {
+    free(final_dest);
+    cleanup_mv_argtable(&args);
+    return 130;  /* 128 + SIGINT(2) */
+  }
 
-  if (show_json) {
+  if (result == MV_SOURCE_KEPT) {
+    if (show_json) {
+      char escaped_source[512];
+      char escaped_error[256];
+      escape_json_string(source, escaped_source, sizeof(escaped_source));
+      escape_json_string(strerror(errno), escaped_error,
+                         sizeof(escaped_error));
+      jbox_printf("{\"status\": \"error\", \"source\": \"%s\", "
+                  "\"message\": \"copied, but cannot remove source: %s\"}\n",
+                  escaped_source, escaped_error);
+    } else {
+      fprintf(stderr, "mv: copied to '%s', but cannot remove '%s': %s\n",
+              final_dest, source, strerror(errno));
+    }
+  } else if (show_json) {
     char escaped_source[512];
     char escaped_dest[512];
     escape_json_string(source, escaped_source, sizeof(escaped_source));
     escape_json_string(final_dest, escaped_dest, sizeof(escaped_dest));
 
     if (result == 0) {
-      printf("{\"status\": \"ok\", \"source\": \"%s\", \"dest\": \"%s\"}\n",
-             escaped_source, escaped_dest);
+      jbox_printf("{\"status\": \"ok\", \"source\": \"%s\", "
+                  "\"dest\": \"%s\"}\n", escaped_source, escaped_dest);
     } else {
       char escaped_error[256];
       escape_json_string(strerror(errno), escaped_error,
                          sizeof(escaped_error));
-      printf("{\"status\": \"error\", \"source\": \"%s\", \"dest\": \"%s\", "
-             "\"message\": \"%s\"}\n",
-             escaped_source, escaped_dest, escaped_error);
+      jbox_printf("{\"status\": \"error\", \"source\": \"%s\", "
+                  "\"dest\": \"%s\", \"message\": \"%s\"}\n",
+                  escaped_source, escaped_dest, escaped_error);
     }
   } else {
     if (result != 0) {
-      fprintf(stderr, "mv: cannot move '%s' to '%s': %s\n",
-              source, final_dest, strerror(errno));
+      if (errno == EEXIST) {
+        fprintf(stderr, "mv: '%s' already exists (use -f to overwrite)\n",
+                final_dest);
+      } else {
+        fprintf(stderr, "mv: cannot move '%s' to '%s': %s\n",
+                source, final_dest, strerror(errno));
+      }
     }
   }
 
@@ -277,7 +466,8 @@ const jshell_cmd_spec_t cmd_mv_spec = {
                "With -f, overwrite existing destination files.",
   .type = CMD_EXTERNAL,
   .run = mv_run,
-  .print_usage = mv_print_usage
+  .print_usage = mv_print_usage,
+  .describe_args = mv_describe_args
 };
 
 
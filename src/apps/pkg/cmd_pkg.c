@@ -5,10 +5,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <dirent.h>
 #include <libgen.h>
+#include <pthread.h>
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
@@ -16,6 +18,12 @@
 #include "pkg_json.h"
 #include "pkg_db.h"
 #include "pkg_registry.h"
+#include "pkg_cache.h"
+#include "pkg_delta.h"
+#include "pkg_files.h"
+#include "pkg_make.h"
+#include "pkg_tar.h"
+#include "utils/jbox_http.h"
 
 
 /** Package manager subcommands. */
@@ -27,6 +35,7 @@ typedef enum {
   PKG_CMD_INSTALL,
   PKG_CMD_REMOVE,
   PKG_CMD_BUILD,
+  PKG_CMD_DELTA,
   PKG_CMD_CHECK_UPDATE,
   PKG_CMD_UPGRADE,
   PKG_CMD_COMPILE
@@ -37,10 +46,11 @@ typedef enum {
 typedef struct {
   struct arg_lit *help;
   struct arg_lit *json;
+  struct arg_int *segments;
   struct arg_rex *subcmd;
   struct arg_str *args;
   struct arg_end *end;
-  void *argtable[5];
+  void *argtable[6];
 } pkg_args_t;
 
 
@@ -49,10 +59,23 @@ typedef struct {
  *  @param dir Directory containing Makefile
  *  @param json_output Whether to output JSON format
  *  @param verbose Whether to print verbose output
+ *  @param force Whether to build even if the sources are unchanged
  *  @return 0 on success, -1 if no Makefile, >0 on compilation failure
  */
 static int compile_package_dir(const char *name, const char *dir,
-                               int json_output, int verbose);
+                               int json_output, int verbose, int force);
+
+
+/** Builds packages just installed, each after the packages it depends on.
+ *  @param db Database recording the installs
+ *  @param names Names of the installed packages
+ *  @param count Number of names
+ *  @param json_output Whether to output in JSON format
+ *  @param failed Set to 1 for each package whose build failed, else 0
+ *  @return Number of failed builds
+ */
+static int build_installed(PkgDb *db, char **names, int count,
+                           int json_output, int *failed);
 
 
 /** Builds the argtable for pkg command.
@@ -61,17 +84,21 @@ static int compile_package_dir(const char *name, const char *dir,
 static void build_pkg_argtable(pkg_args_t *args) {
   args->help = arg_lit0("h", "help", "display this help and exit");
   args->json = arg_lit0(NULL, "json", "output in JSON format");
+  args->segments = arg_int0(NULL, "segments", "N",
+                            "download a package as N parallel byte ranges");
   args->subcmd = arg_rex1(NULL, NULL,
-    "list|info|search|install|remove|build|check-update|upgrade|compile",
+    "list|info|search|install|remove|build|delta|check-update|upgrade|"
+    "compile",
     "COMMAND", ARG_REX_ICASE, "subcommand to run");
   args->args = arg_strn(NULL, NULL, "ARG", 0, 10, "subcommand arguments");
   args->end = arg_end(20);
 
   args->argtable[0] = args->help;
   args->argtable[1] = args->json;
-  args->argtable[2] = args->subcmd;
-  args->argtable[3] = args->args;
-  args->argtable[4] = args->end;
+  args->argtable[2] = args->segments;
+  args->argtable[3] = args->subcmd;
+  args->argtable[4] = args->args;
+  args->argtable[5] = args->end;
 }
 
 
@@ -92,7 +119,9 @@ static void pkg_print_usage(FILE *out) {
   fprintf(out, "Manage jshell packages.\n\n");
   fprintf(out, "Options:\n");
   fprintf(out, "  -h, --help     display this help and exit\n");
-  fprintf(out, "  --json         output in JSON format (where applicable)\n\n");
+  fprintf(out, "  --json         output in JSON format (where applicable)\n");
+  fprintf(out, "  --segments N   install NAME: download as N parallel byte "
+               "ranges\n\n");
   fprintf(out, "Commands:\n");
   fprintf(out, "  list                      list installed packages\n");
   fprintf(out, "  info NAME                 show information about a package\n");
@@ -101,6 +130,8 @@ static void pkg_print_usage(FILE *out) {
   fprintf(out, "  install all               install all packages from registry\n");
   fprintf(out, "  remove NAME               remove an installed package\n");
   fprintf(out, "  build <src> <out.tar.gz>  build a package for distribution\n");
+  fprintf(out, "  delta <old> <new> <out>   write the delta between two "
+               "tarballs\n");
   fprintf(out, "  check-update              check for available updates\n");
   fprintf(out, "  upgrade                   upgrade all packages with updates\n");
   fprintf(out, "  compile [name]            recompile installed package from source\n");
@@ -110,6 +141,20 @@ static void pkg_print_usage(FILE *out) {
 }
 
 
+/**
+ * Passes the pkg argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void pkg_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  pkg_args_t args;
+  build_pkg_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_pkg_argtable(&args);
+}
+
+
 /** Parses a subcommand string into pkg_subcommand_t enum.
  *  @param cmd Subcommand string
  *  @return Corresponding pkg_subcommand_t value or PKG_CMD_NONE if unknown
@@ -121,6 +166,7 @@ static pkg_subcommand_t parse_subcommand(const char *cmd) {
   if (strcmp(cmd, "install") == 0) return PKG_CMD_INSTALL;
   if (strcmp(cmd, "remove") == 0) return PKG_CMD_REMOVE;
   if (strcmp(cmd, "build") == 0) return PKG_CMD_BUILD;
+  if (strcmp(cmd, "delta") == 0) return PKG_CMD_DELTA;
   if (strcmp(cmd, "check-update") == 0) return PKG_CMD_CHECK_UPDATE;
   if (strcmp(cmd, "upgrade") == 0) return PKG_CMD_UPGRADE;
   if (strcmp(cmd, "compile") == 0) return PKG_CMD_COMPILE;
@@ -354,12 +400,406 @@ static int pkg_search(const char *query, int json_output) {
  */
 static int pkg_install_from_tarball(const char *tarball, int json_output);
 
+/** Frees a database loaded by a step of a command, but not the batch
+ *  database it was handed.
+ *  @param db Database in use
+ *  @param batch The caller's batch database, or NULL
+ */
+static void release_db(PkgDb *db, PkgDb *batch) {
+  if (db != batch) {
+    pkg_db_free(db);
+  }
+}
+
+/** Installs a package already extracted into a staging directory.
+ *  @param temp_dir Staging directory; taken over, and either moved into
+ *                  place or removed, and freed
+ *  @param json_output Whether to output in JSON format
+ *  @param batch Database of a multi-package command, which records the
+ *               install and saves it later; NULL to load and save here
+ *  @param compile Whether to build the package now; otherwise the caller
+ *                 builds it later
+ *  @return 0 on success, 1 on error
+ */
+static int pkg_install_from_dir(char *temp_dir, int json_output,
+                                PkgDb *batch, int compile);
+
 /** Installs a single package by name or tarball path.
  *  @param arg Package name or tarball path
  *  @param json_output Whether to output in JSON format
+ *  @param segments Byte ranges to download the tarball as
  *  @return 0 on success, 1 on error
  */
-static int pkg_install_single(const char *arg, int json_output);
+static int pkg_install_single(const char *arg, int json_output,
+                              int segments);
+
+
+/** Installs one downloaded package, on the installer thread.
+ *  @param index Index of the download
+ *  @param downloaded 0 if the download succeeded, -1 if it failed
+ *  @param ctx Caller's context
+ */
+typedef void (*install_step_fn)(int index, int downloaded, void *ctx);
+
+
+/** Downloads waiting for the installer thread, in the order they finished. */
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  int *indices;           // Finished downloads
+  int *results;           // Their results
+  int count;              // Downloads finished
+  int taken;              // Downloads handed to install
+  int finished;           // Whether no more downloads will finish
+  install_step_fn install;
+  void *ctx;
+} install_queue_t;
+
+
+/** Queues a finished download for installation.
+ *  @param index Index of the download
+ *  @param result 0 on success, -1 on error
+ *  @param ctx The install queue
+ */
+static void queue_download(int index, int result, void *ctx) {
+  install_queue_t *q = ctx;
+  pthread_mutex_lock(&q->lock);
+  q->indices[q->count] = index;
+  q->results[q->count] = result;
+  q->count++;
+  pthread_cond_signal(&q->ready);
+  pthread_mutex_unlock(&q->lock);
+}
+
+
+/** Installs downloads as they finish until all are done.
+ *  @param arg The install queue
+ *  @return NULL
+ */
+static void *install_worker(void *arg) {
+  install_queue_t *q = arg;
+  pthread_mutex_lock(&q->lock);
+  for (;;) {
+    while (q->taken == q->count && !q->finished) {
+      pthread_cond_wait(&q->ready, &q->lock);
+    }
+    if (q->taken == q->count) break;
+
+    int index = q->indices[q->taken];
+    int result = q->results[q->taken];
+    q->taken++;
+    pthread_mutex_unlock(&q->lock);
+    q->install(index, result, q->ctx);
+    pthread_mutex_lock(&q->lock);
+  }
+  pthread_mutex_unlock(&q->lock);
+  return NULL;
+}
+
+
+/** Downloads packages in parallel and installs each as soon as it arrives.
+ *  Installs run one at a time on a thread of their own, since they share
+ *  the package database and silence stdout, while later downloads are
+ *  still in flight.
+ *  @param downloads Tarballs to download
+ *  @param count Number of downloads
+ *  @param install Called for each download, in the order they finish
+ *  @param ctx Passed to install
+ *  @return 0 on success, -1 if the installer could not be started
+ */
+static int download_and_install(const PkgDownload *downloads, int count,
+                                install_step_fn install, void *ctx) {
+  install_queue_t q = {
+    .indices = malloc((size_t)(count > 0 ? count : 1) * sizeof(int)),
+    .results = malloc((size_t)(count > 0 ? count : 1) * sizeof(int)),
+    .install = install,
+    .ctx = ctx
+  };
+  if (q.indices == NULL || q.results == NULL) {
+    free(q.indices);
+    free(q.results);
+    return -1;
+  }
+  pthread_mutex_init(&q.lock, NULL);
+  pthread_cond_init(&q.ready, NULL);
+
+  // Without a thread, everything is downloaded first and installed after
+  pthread_t thread;
+  int threaded = pthread_create(&thread, NULL, install_worker, &q) == 0;
+
+  pkg_registry_download_all(downloads, count, PKG_DOWNLOAD_PARALLEL,
+                            queue_download, &q);
+
+  pthread_mutex_lock(&q.lock);
+  q.finished = 1;
+  pthread_cond_signal(&q.ready);
+  pthread_mutex_unlock(&q.lock);
+
+  if (threaded) {
+    pthread_join(thread, NULL);
+  } else {
+    install_worker(&q);
+  }
+
+  pthread_mutex_destroy(&q.lock);
+  pthread_cond_destroy(&q.ready);
+  free(q.indices);
+  free(q.results);
+  return 0;
+}
+
+
+/** Creates an empty staging directory in ~/.jshell/pkgs/_tmp.
+ *  @return Allocated path, or NULL on error
+ */
+static char *make_staging_dir(void) {
+  if (pkg_ensure_tmp_dir() != 0) {
+    return NULL;
+  }
+
+  char *tmp_base = pkg_get_tmp_dir();
+  if (tmp_base == NULL) {
+    return NULL;
+  }
+
+  size_t temp_dir_len = strlen(tmp_base) + strlen("/XXXXXX") + 1;
+  char *temp_dir = malloc(temp_dir_len);
+  if (temp_dir != NULL) {
+    snprintf(temp_dir, temp_dir_len, "%s/XXXXXX", tmp_base);
+    if (mkdtemp(temp_dir) == NULL) {
+      free(temp_dir);
+      temp_dir = NULL;
+    }
+  }
+  free(tmp_base);
+  return temp_dir;
+}
+
+
+/** A package tarball extracted into a staging directory as it downloads. */
+typedef struct {
+  char *dir;              // Staging directory, or NULL
+  PkgTarStream *stream;   // Extracts into dir while the download runs
+  PkgCacheWriter *check;  // Verifies and caches the tarball, or NULL
+  int rejected;           // The extractor refused the data
+  int cached;             // Extracted from the download cache
+  int delta;              // Rebuilt from a delta and the installed version
+} staged_download_t;
+
+
+/** Download sink that verifies and extracts a .tar.gz as it arrives.
+ *  @param data Bytes received
+ *  @param len Number of bytes
+ *  @param ctx The staged_download_t
+ *  @return 0 to go on, -1 to abort the download
+ */
+static int stage_sink(const void *data, size_t len, void *ctx) {
+  staged_download_t *stage = ctx;
+  if (stage->check && pkg_cache_writer_write(stage->check, data, len) != 0) {
+    return -1;
+  }
+  if (pkg_tar_stream_write(stage->stream, data, len) != 0) {
+    stage->rejected = 1;
+    return -1;
+  }
+  return 0;
+}
+
+
+/** Prepares a staging directory and extraction stream for a download.
+ *  @param stage Staged download to set up
+ *  @param sha256 Digest the registry lists for the tarball, or NULL
+ *  @param store Whether to add the tarball to the download cache
+ *  @return 0 on success, -1 on error
+ */
+static int stage_begin(staged_download_t *stage, const char *sha256,
+                       int store) {
+  *stage = (staged_download_t){0};
+  stage->dir = make_staging_dir();
+  if (stage->dir == NULL) {
+    return -1;
+  }
+
+  stage->stream = pkg_tar_stream_new(stage->dir);
+  if (sha256 != NULL) {
+    stage->check = pkg_cache_writer_new(sha256, store);
+  }
+  if (stage->stream == NULL || (sha256 != NULL && stage->check == NULL)) {
+    pkg_tar_stream_finish(stage->stream);
+    pkg_cache_writer_finish(stage->check, 0);
+    pkg_remove_dir_recursive(stage->dir);
+    free(stage->dir);
+    *stage = (staged_download_t){0};
+    return -1;
+  }
+  return 0;
+}
+
+
+/** Completes extraction and verification once a download has finished.
+ *  @param stage Staged download
+ *  @param downloaded 0 if the download succeeded, -1 if it failed
+ *  @return NULL if the package is in stage->dir; otherwise what went
+ *          wrong, and the staging directory is gone
+ */
+static const char *stage_finish(staged_download_t *stage, int downloaded) {
+  // Finished before, from the cache
+  if (stage->stream == NULL) {
+    return stage->dir ? NULL : "staging failed";
+  }
+
+  int extracted = pkg_tar_stream_finish(stage->stream);
+  int verified = stage->check ? pkg_cache_writer_finish(stage->check,
+                                                        downloaded == 0)
+                              : 0;
+  stage->stream = NULL;
+  stage->check = NULL;
+
+  const char *error = NULL;
+  if (stage->rejected) {
+    error = "extraction failed";
+  } else if (downloaded != 0) {
+    error = "download failed";
+  } else if (verified != 0) {
+    error = "checksum mismatch";
+  } else if (extracted != 0) {
+    error = "extraction failed";
+  }
+
+  if (error != NULL) {
+    if (stage->dir) {
+      pkg_remove_dir_recursive(stage->dir);
+    }
+    free(stage->dir);
+    stage->dir = NULL;
+  }
+  return error;
+}
+
+
+/** Stages a package from the download cache instead of the registry.
+ *  @param stage Staged download to set up
+ *  @param sha256 Digest the registry lists for the tarball, or NULL
+ *  @return 0 on a cache hit, -1 if the package must be downloaded
+ */
+static int stage_from_cache(staged_download_t *stage, const char *sha256) {
+  *stage = (staged_download_t){0};
+  if (sha256 == NULL || !pkg_cache_has(sha256)) {
+    return -1;
+  }
+  if (stage_begin(stage, sha256, 0) != 0) {
+    return -1;
+  }
+
+  int read = pkg_cache_read(sha256, stage_sink, stage);
+  if (stage_finish(stage, read) == NULL) {
+    stage->cached = 1;
+    return 0;
+  }
+
+  // A damaged entry is dropped, and the package downloaded again
+  pkg_cache_evict(sha256);
+  return -1;
+}
+
+
+/** Outcome of one package of pkg install all. */
+typedef struct {
+  char *name;
+  char *version;
+  int status;  // 0 = installed, 1 = skipped (already installed), -1 = failed
+  char *error;
+  staged_download_t stage;
+} install_result_t;
+
+
+/** State of pkg install all shared with the installer thread. */
+typedef struct {
+  PkgRegistryList *packages;
+  install_result_t *results;
+  int *slots;  // Package index of each download
+  PkgDb *db;   // Records the installs, saved once at the end
+  int json_output;
+  int installed_count;
+  int failed_count;
+} install_all_t;
+
+
+/** Installs a staged package for pkg install all.
+ *  @param state The install_all_t state
+ *  @param i Index of the package
+ *  @param downloaded 0 if the download succeeded, -1 if it failed
+ */
+static void install_staged(install_all_t *state, int i, int downloaded) {
+  PkgRegistryEntry *pkg = &state->packages->entries[i];
+  install_result_t *result = &state->results[i];
+
+  if (!state->json_output) {
+    printf("  Installing %s", pkg->name);
+    if (pkg->latest_version) {
+      printf(" %s", pkg->latest_version);
+    }
+    printf("%s...\n", result->stage.cached ? " (cached)" : "");
+  }
+
+  const char *error = stage_finish(&result->stage, downloaded);
+  if (error != NULL) {
+    result->status = -1;
+    result->error = strdup(error);
+    state->failed_count++;
+    if (!state->json_output) {
+      printf("    FAILED: %s\n", error);
+    }
+    return;
+  }
+
+  // Install silently
+  FILE *devnull = fopen("/dev/null", "w");
+  FILE *orig_stdout = stdout;
+  FILE *orig_stderr = stderr;
+  fflush(stdout);
+  if (devnull) {
+    stdout = devnull;
+    stderr = devnull;
+  }
+
+  int install_result = pkg_install_from_dir(result->stage.dir, 0, state->db,
+                                            0);
+  result->stage.dir = NULL;
+
+  if (devnull) {
+    stdout = orig_stdout;
+    stderr = orig_stderr;
+    fclose(devnull);
+  }
+
+  if (install_result == 0) {
+    result->status = 0;
+    state->installed_count++;
+    if (!state->json_output) {
+      printf("    OK\n");
+    }
+  } else {
+    result->status = -1;
+    result->error = strdup("installation failed");
+    state->failed_count++;
+    if (!state->json_output) {
+      printf("    FAILED: installation error\n");
+    }
+  }
+  fflush(stdout);
+}
+
+
+/** Installs a downloaded package for pkg install all.
+ *  @param index Index of the download
+ *  @param downloaded 0 if the download succeeded, -1 if it failed
+ *  @param ctx The install_all_t state
+ */
+static void install_downloaded(int index, int downloaded, void *ctx) {
+  install_all_t *state = ctx;
+  install_staged(state, state->slots[index], downloaded);
+}
 
 
 /** Installs all packages available in the registry.
@@ -407,136 +847,135 @@ static int pkg_install_all(int json_output) {
     return 1;
   }
 
-  // Track results
-  typedef struct {
-    char *name;
-    char *version;
-    int status;  // 0 = installed, 1 = skipped (already installed), -1 = failed
-    char *error;
-  } install_result_t;
-
   install_result_t *results = malloc((size_t)all_packages->count
                                      * sizeof(install_result_t));
-  if (results == NULL) {
+  PkgDownload *downloads = malloc((size_t)all_packages->count
+                                  * sizeof(PkgDownload));
+  install_all_t state = {
+    .packages = all_packages,
+    .results = results,
+    .slots = malloc((size_t)all_packages->count * sizeof(int)),
+    .db = db,
+    .json_output = json_output
+  };
+  if (results == NULL || downloads == NULL || state.slots == NULL) {
+    free(results);
+    free(downloads);
+    free(state.slots);
     pkg_db_free(db);
     pkg_registry_list_free(all_packages);
     return 1;
   }
 
-  int installed_count = 0;
   int skipped_count = 0;
-  int failed_count = 0;
+  int download_count = 0;
 
   if (!json_output) {
     printf("Found %d package(s) in registry.\n\n", all_packages->count);
   }
 
+  // Settle what needs no download, and queue the rest
   for (int i = 0; i < all_packages->count; i++) {
     PkgRegistryEntry *pkg = &all_packages->entries[i];
     results[i].name = strdup(pkg->name);
     results[i].version = pkg->latest_version ? strdup(pkg->latest_version)
                                              : NULL;
     results[i].error = NULL;
+    results[i].stage = (staged_download_t){0};
 
-    // Check if already installed
+    // Check if already installed, or listed twice
     PkgDbEntry *existing = pkg_db_find(db, pkg->name);
-    if (existing != NULL) {
+    int duplicate = 0;
+    for (int j = 0; j < i && !existing && !duplicate; j++) {
+      duplicate = strcmp(all_packages->entries[j].name, pkg->name) == 0;
+    }
+    if (existing != NULL || duplicate) {
       results[i].status = 1;  // skipped
       skipped_count++;
-      if (!json_output) {
+      if (!json_output && existing) {
         printf("  Skipping %s (already installed: %s)\n",
                pkg->name, existing->version);
+      } else if (!json_output) {
+        printf("  Skipping %s (listed twice)\n", pkg->name);
       }
       continue;
     }
 
-    if (!json_output) {
-      printf("  Installing %s", pkg->name);
-      if (pkg->latest_version) {
-        printf(" %s", pkg->latest_version);
-      }
-      printf("...\n");
-    }
-
-    if (pkg->download_url == NULL) {
+    const char *url = pkg_registry_entry_url(pkg);
+    const char *sha256 = pkg_registry_entry_sha256(pkg);
+    if (url == NULL) {
       results[i].status = -1;
       results[i].error = strdup("no download URL");
-      failed_count++;
+      state.failed_count++;
       if (!json_output) {
-        printf("    FAILED: no download URL\n");
+        printf("  FAILED %s: no download URL\n", pkg->name);
       }
       continue;
     }
 
-    // Download to temp file
-    char temp_path[] = "/tmp/pkg-install-all-XXXXXX.tar.gz";
-    int fd = mkstemps(temp_path, 7);
-    if (fd < 0) {
-      results[i].status = -1;
-      results[i].error = strdup("temp file creation failed");
-      failed_count++;
-      if (!json_output) {
-        printf("    FAILED: could not create temp file\n");
-      }
+    // Install from the cache, or extract straight into a staging
+    // directory as it downloads
+    if (stage_from_cache(&results[i].stage, sha256) == 0) {
+      install_staged(&state, i, 0);
       continue;
     }
-    close(fd);
-
-    if (pkg_registry_download(pkg->download_url, temp_path) != 0) {
+    if (stage_begin(&results[i].stage, sha256, 1) != 0) {
       results[i].status = -1;
-      results[i].error = strdup("download failed");
-      failed_count++;
-      remove(temp_path);
+      results[i].error = strdup("staging directory creation failed");
+      state.failed_count++;
       if (!json_output) {
-        printf("    FAILED: download error\n");
+        printf("  FAILED %s: could not create staging directory\n",
+               pkg->name);
       }
       continue;
     }
 
-    // Install silently
-    FILE *devnull = fopen("/dev/null", "w");
-    FILE *orig_stdout = stdout;
-    FILE *orig_stderr = stderr;
-    if (devnull) {
-      stdout = devnull;
-      stderr = devnull;
-    }
+    downloads[download_count].url = url;
+    downloads[download_count].sink = stage_sink;
+    downloads[download_count].ctx = &results[i].stage;
+    state.slots[download_count] = i;
+    download_count++;
+  }
 
-    int install_result = pkg_install_from_tarball(temp_path, 0);
+  if (download_count > 0 && !json_output) {
+    printf("  Downloading %d package(s), up to %d at once...\n",
+           download_count, PKG_DOWNLOAD_PARALLEL);
+    fflush(stdout);
+  }
+  download_and_install(downloads, download_count, install_downloaded,
+                       &state);
+  free(downloads);
+  free(state.slots);
 
-    if (devnull) {
-      stdout = orig_stdout;
-      stderr = orig_stderr;
-      fclose(devnull);
+  // Build what was installed, in dependency order
+  int installed_count = state.installed_count;
+  char **built = malloc((size_t)all_packages->count * sizeof(char *));
+  int *build_failed = calloc((size_t)all_packages->count, sizeof(int));
+  int built_count = 0;
+  int build_failed_count = 0;
+  for (int i = 0; built && i < all_packages->count; i++) {
+    if (results[i].status == 0) {
+      built[built_count++] = results[i].name;
     }
-
-    remove(temp_path);
-
-    if (install_result == 0) {
-      results[i].status = 0;
-      installed_count++;
-      if (!json_output) {
-        printf("    OK\n");
-      }
-      // Reload db to see newly installed package
-      pkg_db_free(db);
-      db = pkg_db_load();
-      if (db == NULL) {
-        // Try to continue anyway
-        db = pkg_db_load();
-      }
-    } else {
-      results[i].status = -1;
-      results[i].error = strdup("installation failed");
-      failed_count++;
-      if (!json_output) {
-        printf("    FAILED: installation error\n");
-      }
+  }
+  if (built_count > 0 && build_failed != NULL) {
+    if (!json_output) {
+      printf("\nCompiling installed packages...\n");
+      fflush(stdout);
     }
+    build_failed_count = build_installed(db, built, built_count,
+                                         json_output, build_failed);
   }
 
+  // Record every install in one write
+  int save_failed = state.installed_count > 0 && pkg_db_save(db) != 0;
+  if (save_failed) {
+    fprintf(stderr, "pkg install all: failed to update package database\n");
+  }
   pkg_db_free(db);
 
+  int failed_count = state.failed_count;
+
   // Output results
   if (json_output) {
     printf("{\"status\": \"%s\", \"installed\": [",
@@ -569,47 +1008,68 @@ static int pkg_install_all(int json_output) {
       printf("{\"name\": \"%s\", \"error\": \"%s\"}",
              results[i].name, results[i].error ? results[i].error : "unknown");
     }
+    printf("], \"build_failed\": [");
+    first = 1;
+    for (int i = 0; build_failed_count > 0 && i < built_count; i++) {
+      if (!build_failed[i]) continue;
+      if (!first) printf(", ");
+      first = 0;
+      printf("\"%s\"", built[i]);
+    }
     printf("]}\n");
   } else {
     printf("\n");
     printf("Installed: %d, Skipped: %d, Failed: %d\n",
            installed_count, skipped_count, failed_count);
+    if (build_failed_count > 0) {
+      printf("%d package(s) failed to compile and use their pre-built "
+             "binaries\n", build_failed_count);
+    }
   }
+  free(built);
+  free(build_failed);
 
   // Cleanup
   for (int i = 0; i < all_packages->count; i++) {
     free(results[i].name);
     free(results[i].version);
     free(results[i].error);
+    if (results[i].stage.stream) {
+      stage_finish(&results[i].stage, -1);
+    }
   }
   free(results);
   pkg_registry_list_free(all_packages);
 
-  return failed_count > 0 ? 1 : 0;
+  return failed_count > 0 || save_failed ? 1 : 0;
 }
 
 
 /** Installs a package or all packages.
  *  @param arg Package name, tarball path, or "all" for all packages
  *  @param json_output Whether to output in JSON format
+ *  @param segments Byte ranges to download a single package as
  *  @return 0 on success, 1 on error
  */
-static int pkg_install(const char *arg, int json_output) {
+static int pkg_install(const char *arg, int json_output, int segments) {
   // Handle "pkg install all" special case
   if (arg != NULL && strcmp(arg, "all") == 0) {
     return pkg_install_all(json_output);
   }
 
-  return pkg_install_single(arg, json_output);
+  return pkg_install_single(arg, json_output, segments);
 }
 
 
 /** Implementation of pkg_install_single.
  *  @param arg Package name or tarball path
  *  @param json_output Whether to output in JSON format
+ *  @param segments Byte ranges to download the tarball as; 1 for one
+ *         stream
  *  @return 0 on success, 1 on error
  */
-static int pkg_install_single(const char *arg, int json_output) {
+static int pkg_install_single(const char *arg, int json_output,
+                              int segments) {
   if (arg == NULL) {
     if (json_output) {
       printf("{\"status\": \"error\", "
@@ -698,7 +1158,11 @@ static int pkg_install_single(const char *arg, int json_output) {
     return 1;
   }
 
-  if (entry->download_url == NULL) {
+  // A prebuilt tarball for this machine needs no compile; without one
+  // the source tarball is installed and built
+  const char *url = pkg_registry_entry_url(entry);
+  const char *sha256 = pkg_registry_entry_sha256(entry);
+  if (url == NULL) {
     if (json_output) {
       printf("{\"status\": \"error\", "
              "\"message\": \"no download URL for package\", "
@@ -711,81 +1175,72 @@ static int pkg_install_single(const char *arg, int json_output) {
     return 1;
   }
 
-  // Ensure temp directory exists
-  if (pkg_ensure_tmp_dir() != 0) {
-    if (json_output) {
-      printf("{\"status\": \"error\", "
-             "\"message\": \"failed to create temp directory\"}\n");
-    } else {
-      fprintf(stderr, "pkg install: failed to create temp directory\n");
+  // Install from the cache if the tarball is there; otherwise extract
+  // into a staging directory as the download arrives
+  staged_download_t stage;
+  if (stage_from_cache(&stage, sha256) == 0) {
+    if (!json_output) {
+      printf("Using cached %s %s\n", entry->name, entry->latest_version);
     }
     free(pkg_name);
     pkg_registry_entry_free(entry);
-    return 1;
-  }
-
-  // Download to temp file in ~/.jshell/pkgs/_tmp
-  char *tmp_dir = pkg_get_tmp_dir();
-  if (tmp_dir == NULL) {
-    free(pkg_name);
-    pkg_registry_entry_free(entry);
-    return 1;
-  }
-
-  size_t temp_path_len = strlen(tmp_dir) + strlen("/XXXXXX.tar.gz") + 1;
-  char *temp_path = malloc(temp_path_len);
-  if (temp_path == NULL) {
-    free(tmp_dir);
-    free(pkg_name);
-    pkg_registry_entry_free(entry);
-    return 1;
+    return pkg_install_from_dir(stage.dir, json_output, NULL, 1);
   }
-  snprintf(temp_path, temp_path_len, "%s/XXXXXX.tar.gz", tmp_dir);
-  free(tmp_dir);
-
-  int fd = mkstemps(temp_path, 7);
-  if (fd < 0) {
+  if (stage_begin(&stage, sha256, 1) != 0) {
     if (json_output) {
       printf("{\"status\": \"error\", "
-             "\"message\": \"failed to create temp file\"}\n");
+             "\"message\": \"failed to create temp directory\"}\n");
     } else {
-      fprintf(stderr, "pkg install: failed to create temp file\n");
+      fprintf(stderr, "pkg install: failed to create temp directory\n");
     }
-    free(temp_path);
     free(pkg_name);
     pkg_registry_entry_free(entry);
     return 1;
   }
-  close(fd);
 
   if (!json_output) {
-    printf("Downloading %s...\n", entry->download_url);
+    printf("Downloading %s...\n", url);
   }
 
-  if (pkg_registry_download(entry->download_url, temp_path) != 0) {
+  int downloaded = pkg_registry_download_segmented(url, segments,
+                                                   stage_sink, &stage);
+  const char *error = stage_finish(&stage, downloaded);
+  if (error == NULL) {
+    // Installed below
+  } else if (strcmp(error, "download failed") == 0) {
     if (json_output) {
       printf("{\"status\": \"error\", "
              "\"message\": \"download failed\", "
-             "\"url\": \"%s\"}\n", entry->download_url);
+             "\"url\": \"%s\"}\n", url);
     } else {
       fprintf(stderr, "pkg install: download failed from %s\n",
-              entry->download_url);
+              url);
+    }
+  } else if (strcmp(error, "checksum mismatch") == 0) {
+    if (json_output) {
+      printf("{\"status\": \"error\", "
+             "\"message\": \"checksum mismatch\", "
+             "\"url\": \"%s\"}\n", url);
+    } else {
+      fprintf(stderr, "pkg install: checksum mismatch for %s\n",
+              url);
+    }
+  } else {
+    if (json_output) {
+      printf("{\"status\": \"error\", "
+             "\"message\": \"failed to extract tarball\"}\n");
+    } else {
+      fprintf(stderr, "pkg install: failed to extract tarball\n");
     }
-    remove(temp_path);
-    free(temp_path);
-    free(pkg_name);
-    pkg_registry_entry_free(entry);
-    return 1;
   }
 
   free(pkg_name);
   pkg_registry_entry_free(entry);
+  if (error != NULL) {
+    return 1;
+  }
 
-  // Install from downloaded tarball
-  int result = pkg_install_from_tarball(temp_path, json_output);
-  remove(temp_path);
-  free(temp_path);
-  return result;
+  return pkg_install_from_dir(stage.dir, json_output, NULL, 1);
 }
 
 
@@ -795,44 +1250,18 @@ static int pkg_install_single(const char *arg, int json_output) {
  *  @return 0 on success, 1 on error
  */
 static int pkg_install_from_tarball(const char *tarball, int json_output) {
-  if (pkg_ensure_tmp_dir() != 0) {
-    if (json_output) {
-      printf("{\"status\": \"error\", "
-             "\"message\": \"failed to create package directories\"}\n");
-    } else {
-      fprintf(stderr, "pkg install: failed to create package directories\n");
-    }
-    return 1;
-  }
-
-  // Create temp extraction dir in ~/.jshell/pkgs/_tmp
-  char *tmp_base = pkg_get_tmp_dir();
-  if (tmp_base == NULL) {
-    return 1;
-  }
-
-  size_t temp_dir_len = strlen(tmp_base) + strlen("/XXXXXX") + 1;
-  char *temp_dir = malloc(temp_dir_len);
+  char *temp_dir = make_staging_dir();
   if (temp_dir == NULL) {
-    free(tmp_base);
-    return 1;
-  }
-  snprintf(temp_dir, temp_dir_len, "%s/XXXXXX", tmp_base);
-  free(tmp_base);
-
-  if (mkdtemp(temp_dir) == NULL) {
     if (json_output) {
       printf("{\"status\": \"error\", "
              "\"message\": \"failed to create temp directory\"}\n");
     } else {
       fprintf(stderr, "pkg install: failed to create temp directory\n");
     }
-    free(temp_dir);
     return 1;
   }
 
-  char *tar_argv[] = {"tar", "-xzf", (char *)tarball, "-C", temp_dir, NULL};
-  if (pkg_run_command(tar_argv) != 0) {
+  if (pkg_tar_extract_file(tarball, temp_dir) != 0) {
     if (json_output) {
       printf("{\"status\": \"error\", "
              "\"message\": \"failed to extract tarball\"}\n");
@@ -844,6 +1273,31 @@ static int pkg_install_from_tarball(const char *tarball, int json_output) {
     return 1;
   }
 
+  return pkg_install_from_dir(temp_dir, json_output, NULL, 1);
+}
+
+
+/** Checks whether a package directory can be built with make.
+ *  @param dir Package directory
+ *  @return 1 if it has a Makefile, else 0
+ */
+static int has_makefile(const char *dir) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/Makefile", dir);
+  struct stat st;
+  return stat(path, &st) == 0;
+}
+
+
+/** Implementation of pkg_install_from_dir.
+ *  @param temp_dir Staging directory holding the extracted package
+ *  @param json_output Whether to output in JSON format
+ *  @param batch Database to record the install in, or NULL
+ *  @param compile Whether to build the package now
+ *  @return 0 on success, 1 on error
+ */
+static int pkg_install_from_dir(char *temp_dir, int json_output,
+                                PkgDb *batch, int compile) {
   size_t manifest_path_len = strlen(temp_dir) + strlen("/pkg.json") + 1;
   char *manifest_path = malloc(manifest_path_len);
   if (manifest_path == NULL) {
@@ -881,7 +1335,44 @@ static int pkg_install_from_tarball(const char *tarball, int json_output) {
     return 1;
   }
 
-  PkgDb *db = pkg_db_load();
+  const char *bad_file = NULL;
+  if (pkg_files_verify(temp_dir, m, &bad_file) != 0) {
+    if (json_output) {
+      printf("{\"status\": \"error\", "
+             "\"message\": \"file does not match its hash\", "
+             "\"file\": \"%s\"}\n", bad_file);
+    } else {
+      fprintf(stderr, "pkg install: %s does not match its hash in "
+              "pkg.json\n", bad_file);
+    }
+    pkg_manifest_free(m);
+    pkg_remove_dir_recursive(temp_dir);
+    free(temp_dir);
+    return 1;
+  }
+
+  // A prebuilt package only runs where it was built, unless it brings
+  // the sources to build it again
+  char platform[128];
+  if (m->platform != NULL
+      && (pkg_platform(platform, sizeof(platform)) != 0
+          || strcmp(m->platform, platform) != 0)
+      && !has_makefile(temp_dir)) {
+    if (json_output) {
+      printf("{\"status\": \"error\", "
+             "\"message\": \"package built for another platform\", "
+             "\"platform\": \"%s\"}\n", m->platform);
+    } else {
+      fprintf(stderr, "pkg install: %s was built for %s, not this machine\n",
+              m->name, m->platform);
+    }
+    pkg_manifest_free(m);
+    pkg_remove_dir_recursive(temp_dir);
+    free(temp_dir);
+    return 1;
+  }
+
+  PkgDb *db = batch != NULL ? batch : pkg_db_load();
   if (db == NULL) {
     pkg_manifest_free(m);
     pkg_remove_dir_recursive(temp_dir);
@@ -900,7 +1391,7 @@ static int pkg_install_from_tarball(const char *tarball, int json_output) {
       fprintf(stderr, "pkg install: package '%s' already installed "
               "(version %s)\n", m->name, existing->version);
     }
-    pkg_db_free(db);
+    release_db(db, batch);
     pkg_manifest_free(m);
     pkg_remove_dir_recursive(temp_dir);
     free(temp_dir);
@@ -909,7 +1400,7 @@ static int pkg_install_from_tarball(const char *tarball, int json_output) {
 
   char *pkgs_dir = pkg_get_pkgs_dir();
   if (pkgs_dir == NULL) {
-    pkg_db_free(db);
+    release_db(db, batch);
     pkg_manifest_free(m);
     pkg_remove_dir_recursive(temp_dir);
     free(temp_dir);
@@ -921,7 +1412,7 @@ static int pkg_install_from_tarball(const char *tarball, int json_output) {
   char *install_path = malloc(install_path_len);
   if (install_path == NULL) {
     free(pkgs_dir);
-    pkg_db_free(db);
+    release_db(db, batch);
     pkg_manifest_free(m);
     pkg_remove_dir_recursive(temp_dir);
     free(temp_dir);
@@ -942,7 +1433,7 @@ static int pkg_install_from_tarball(const char *tarball, int json_output) {
         fprintf(stderr, "pkg install: failed to copy package\n");
       }
       free(install_path);
-      pkg_db_free(db);
+      release_db(db, batch);
       pkg_manifest_free(m);
       pkg_remove_dir_recursive(temp_dir);
       free(temp_dir);
@@ -954,16 +1445,20 @@ static int pkg_install_from_tarball(const char *tarball, int json_output) {
     // rename succeeded, temp_dir is now install_path
     free(temp_dir);
   }
+  pkg_files_dedup(install_path, m);
 
   // Compile package if it has a Makefile
-  char makefile_path[4096];
-  snprintf(makefile_path, sizeof(makefile_path), "%s/Makefile", install_path);
-  struct stat makefile_st;
-  if (stat(makefile_path, &makefile_st) == 0) {
+  if (compile && has_makefile(install_path)) {
+    for (int i = 0; i < m->dependencies_count; i++) {
+      if (!json_output && pkg_db_find(db, m->dependencies[i]) == NULL) {
+        fprintf(stderr, "Warning: %s depends on %s, which is not installed\n",
+                m->name, m->dependencies[i]);
+      }
+    }
     if (!json_output) {
       printf("Compiling %s...\n", m->name);
     }
-    int compile_result = compile_package_dir(m->name, install_path, 0, 0);
+    int compile_result = compile_package_dir(m->name, install_path, 0, 0, 1);
     if (compile_result != 0) {
       if (!json_output) {
         fprintf(stderr, "Warning: compilation failed, using pre-built binary\n");
@@ -974,7 +1469,7 @@ static int pkg_install_from_tarball(const char *tarball, int json_output) {
   char *bin_dir = pkg_get_bin_dir();
   if (bin_dir == NULL) {
     free(install_path);
-    pkg_db_free(db);
+    release_db(db, batch);
     pkg_manifest_free(m);
     return 1;
   }
@@ -1014,7 +1509,9 @@ static int pkg_install_from_tarball(const char *tarball, int json_output) {
 
   pkg_db_add_full(db, m->name, m->version, m->description,
                   m->files, m->files_count);
-  pkg_db_save(db);
+  if (batch == NULL) {
+    pkg_db_save(db);
+  }
 
   if (json_output) {
     printf("{\"status\": \"ok\", \"name\": \"%s\", \"version\": \"%s\", "
@@ -1024,7 +1521,7 @@ static int pkg_install_from_tarball(const char *tarball, int json_output) {
   }
 
   free(install_path);
-  pkg_db_free(db);
+  release_db(db, batch);
   pkg_manifest_free(m);
   return 0;
 }
@@ -1033,9 +1530,11 @@ static int pkg_install_from_tarball(const char *tarball, int json_output) {
 /** Removes an installed package.
  *  @param name Package name
  *  @param json_output Whether to output in JSON format
+ *  @param batch Database of a multi-package command, which records the
+ *               removal and saves it later; NULL to load and save here
  *  @return 0 on success, 1 on error
  */
-static int pkg_remove(const char *name, int json_output) {
+static int pkg_remove(const char *name, int json_output, PkgDb *batch) {
   if (name == NULL) {
     if (json_output) {
       printf("{\"status\": \"error\", "
@@ -1046,7 +1545,7 @@ static int pkg_remove(const char *name, int json_output) {
     return 1;
   }
 
-  PkgDb *db = pkg_db_load();
+  PkgDb *db = batch != NULL ? batch : pkg_db_load();
   if (db == NULL) {
     if (json_output) {
       printf("{\"status\": \"error\", "
@@ -1065,20 +1564,20 @@ static int pkg_remove(const char *name, int json_output) {
     } else {
       fprintf(stderr, "pkg remove: package '%s' not installed\n", name);
     }
-    pkg_db_free(db);
+    release_db(db, batch);
     return 1;
   }
 
   char *version = strdup(entry->version);
   if (version == NULL) {
-    pkg_db_free(db);
+    release_db(db, batch);
     return 1;
   }
 
   char *pkgs_dir = pkg_get_pkgs_dir();
   if (pkgs_dir == NULL) {
     free(version);
-    pkg_db_free(db);
+    release_db(db, batch);
     return 1;
   }
 
@@ -1087,7 +1586,7 @@ static int pkg_remove(const char *name, int json_output) {
   if (pkg_path == NULL) {
     free(pkgs_dir);
     free(version);
-    pkg_db_free(db);
+    release_db(db, batch);
     return 1;
   }
   snprintf(pkg_path, pkg_path_len, "%s/%s-%s", pkgs_dir, name, version);
@@ -1098,7 +1597,7 @@ static int pkg_remove(const char *name, int json_output) {
   if (manifest_path == NULL) {
     free(pkg_path);
     free(version);
-    pkg_db_free(db);
+    release_db(db, batch);
     return 1;
   }
   snprintf(manifest_path, manifest_path_len, "%s/pkg.json", pkg_path);
@@ -1133,10 +1632,6 @@ static int pkg_remove(const char *name, int json_output) {
     free(bin_dir);
   }
 
-  if (m != NULL) {
-    pkg_manifest_free(m);
-  }
-
   if (pkg_remove_dir_recursive(pkg_path) != 0) {
     if (json_output) {
       printf("{\"status\": \"error\", "
@@ -1144,16 +1639,21 @@ static int pkg_remove(const char *name, int json_output) {
     } else {
       fprintf(stderr, "pkg remove: failed to remove package directory\n");
     }
+    pkg_manifest_free(m);
     free(pkg_path);
     free(version);
-    pkg_db_free(db);
+    release_db(db, batch);
     return 1;
   }
 
+  if (m != NULL) {
+    pkg_files_release(m);
+    pkg_manifest_free(m);
+  }
   free(pkg_path);
 
   pkg_db_remove(db, name);
-  if (pkg_db_save(db) != 0) {
+  if (batch == NULL && pkg_db_save(db) != 0) {
     if (json_output) {
       printf("{\"status\": \"error\", "
              "\"message\": \"failed to update package database\"}\n");
@@ -1161,7 +1661,7 @@ static int pkg_remove(const char *name, int json_output) {
       fprintf(stderr, "pkg remove: failed to update package database\n");
     }
     free(version);
-    pkg_db_free(db);
+    release_db(db, batch);
     return 1;
   }
 
@@ -1173,7 +1673,7 @@ static int pkg_remove(const char *name, int json_output) {
   }
 
   free(version);
-  pkg_db_free(db);
+  release_db(db, batch);
   return 0;
 }
 
@@ -1275,9 +1775,35 @@ static int pkg_build(const char *src_dir, const char *output_tar,
     free(file_path);
   }
 
-  char *tar_argv[] = {"tar", "-czf", (char *)output_tar, "-C", (char *)src_dir,
-                      ".", NULL};
-  if (pkg_run_command(tar_argv) != 0) {
+  // Pack everything under src_dir, hashing files on the walker threads
+  // and compressing on all cores, with the digests added to pkg.json
+  int fd = open(output_tar, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  PkgFileList files = {0};
+  char *manifest = NULL;
+  char *manifest_text = NULL;
+  int built = fd >= 0 && fstat(fd, &st) == 0 &&
+              pkg_files_scan(src_dir, &st, &files) == 0;
+  if (built) {
+    size_t path_len = strlen(src_dir) + strlen("/pkg.json") + 1;
+    char *path = malloc(path_len);
+    if (path != NULL) {
+      snprintf(path, path_len, "%s/pkg.json", src_dir);
+      manifest_text = pkg_read_file(path);
+      free(path);
+    }
+    manifest = manifest_text != NULL
+               ? pkg_files_manifest(manifest_text, &files) : NULL;
+    built = manifest != NULL &&
+            pkg_tar_create(fd, src_dir, &files, manifest) == 0;
+  }
+  if (fd >= 0 && close(fd) != 0) built = 0;
+  free(manifest_text);
+  free(manifest);
+  size_t file_count = files.count;
+  pkg_files_free(&files);
+
+  if (!built) {
+    if (fd >= 0) unlink(output_tar);
     if (json_output) {
       printf("{\"status\": \"error\", "
              "\"message\": \"failed to create tarball\"}\n");
@@ -1290,7 +1816,8 @@ static int pkg_build(const char *src_dir, const char *output_tar,
 
   if (json_output) {
     printf("{\"status\": \"ok\", \"package\": \"%s\", \"version\": \"%s\", "
-           "\"output\": \"%s\"}\n", m->name, m->version, output_tar);
+           "\"output\": \"%s\", \"entries\": %zu}\n", m->name, m->version,
+           output_tar, file_count);
   } else {
     printf("Created package: %s\n", output_tar);
   }
@@ -1300,6 +1827,75 @@ static int pkg_build(const char *src_dir, const char *output_tar,
 }
 
 
+/** Writes the delta from one package tarball to a later one.
+ *  @param old_tar Tarball of the older version
+ *  @param new_tar Tarball of the newer version
+ *  @param output Path of the delta to write
+ *  @param json_output Whether to output in JSON format
+ *  @return 0 on success, 1 on error
+ */
+static int pkg_delta(const char *old_tar, const char *new_tar,
+                     const char *output, int json_output) {
+  if (old_tar == NULL || new_tar == NULL || output == NULL) {
+    if (json_output) {
+      printf("{\"status\": \"error\", "
+             "\"message\": \"two tarballs and an output path required\"}\n");
+    } else {
+      fprintf(stderr, "pkg delta: two tarballs and an output path required\n");
+      fprintf(stderr, "Usage: pkg delta <old.tar.gz> <new.tar.gz> <out>\n");
+    }
+    return 1;
+  }
+
+  char *old_dir = make_staging_dir();
+  char *new_dir = make_staging_dir();
+  const char *error = NULL;
+  if (old_dir == NULL || new_dir == NULL) {
+    error = "failed to create staging directory";
+  } else if (pkg_tar_extract_file(old_tar, old_dir) != 0 ||
+             pkg_tar_extract_file(new_tar, new_dir) != 0) {
+    error = "failed to extract tarball";
+  }
+
+  off_t size = 0;
+  if (error == NULL) {
+    int fd = open(output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    struct stat st;
+    int written = fd >= 0 && pkg_delta_create(fd, old_dir, new_dir) == 0 &&
+                  fstat(fd, &st) == 0;
+    if (fd >= 0 && close(fd) != 0) written = 0;
+    if (written) {
+      size = st.st_size;
+    } else {
+      if (fd >= 0) unlink(output);
+      error = "failed to create delta";
+    }
+  }
+
+  if (old_dir != NULL) pkg_remove_dir_recursive(old_dir);
+  if (new_dir != NULL) pkg_remove_dir_recursive(new_dir);
+  free(old_dir);
+  free(new_dir);
+
+  if (error != NULL) {
+    if (json_output) {
+      printf("{\"status\": \"error\", \"message\": \"%s\"}\n", error);
+    } else {
+      fprintf(stderr, "pkg delta: %s\n", error);
+    }
+    return 1;
+  }
+
+  if (json_output) {
+    printf("{\"status\": \"ok\", \"output\": \"%s\", \"size\": %lld}\n",
+           output, (long long)size);
+  } else {
+    printf("Created delta: %s\n", output);
+  }
+  return 0;
+}
+
+
 /** Checks for available package updates.
  *  @param json_output Whether to output in JSON format
  *  @return 0 on success, 1 on error
@@ -1345,6 +1941,21 @@ static int pkg_check_update(int json_output) {
   int updates_available = 0;
   int errors = 0;
 
+  // One request for all installed packages; a registry without the batch
+  // endpoint is asked for its whole listing instead
+  const char **names = malloc((size_t)db->count * sizeof(char *));
+  PkgRegistryList *registry = NULL;
+  if (names != NULL) {
+    for (int i = 0; i < db->count; i++) {
+      names[i] = db->entries[i].name;
+    }
+    registry = pkg_registry_fetch_versions(names, db->count);
+    free(names);
+  }
+  if (registry == NULL) {
+    registry = pkg_registry_fetch_all();
+  }
+
   for (int i = 0; i < db->count; i++) {
     PkgDbEntry *entry = &db->entries[i];
     packages[i].name = strdup(entry->name);
@@ -1352,7 +1963,13 @@ static int pkg_check_update(int json_output) {
     packages[i].available = NULL;
     packages[i].has_update = -1;
 
-    PkgRegistryEntry *reg_entry = pkg_registry_fetch_package(entry->name);
+    PkgRegistryEntry *reg_entry = NULL;
+    for (int j = 0; registry && j < registry->count && !reg_entry; j++) {
+      if (registry->entries[j].name && registry->entries[j].latest_version &&
+          strcmp(registry->entries[j].name, entry->name) == 0) {
+        reg_entry = &registry->entries[j];
+      }
+    }
     if (reg_entry == NULL) {
       errors++;
       continue;
@@ -1368,9 +1985,8 @@ static int pkg_check_update(int json_output) {
       packages[i].has_update = 0;
       up_to_date++;
     }
-
-    pkg_registry_entry_free(reg_entry);
   }
+  pkg_registry_list_free(registry);
 
   if (json_output) {
     printf("{\"status\": \"ok\", \"summary\": {\"up_to_date\": %d, "
@@ -1444,6 +2060,259 @@ static int pkg_check_update(int json_output) {
 }
 
 
+/** A package with an update, for pkg upgrade. */
+typedef struct {
+  char *name;
+  char *installed;
+  char *available;
+  char *download_url;
+  char *sha256;
+  char *installed_dir;    // Where the installed version is
+  char *delta_url;        // Delta from the installed version, or NULL
+  char *delta_sha256;
+} upgrade_entry_t;
+
+
+/** Outcome of one package of pkg upgrade. */
+typedef struct {
+  char *name;
+  char *from;
+  char *to;
+  int success;
+  char *error;
+  staged_download_t stage;
+} upgrade_result_t;
+
+
+/** State of pkg upgrade shared with the installer thread. */
+typedef struct {
+  upgrade_entry_t *upgrades;
+  upgrade_result_t *results;
+  int *slots;  // Upgrade index of each download
+  PkgDb *db;   // Records the upgrades, saved once at the end
+  int json_output;
+  int success_count;
+  int fail_count;
+} upgrade_all_t;
+
+
+/** Replaces an installed package with its staged update, for pkg upgrade.
+ *  @param state The upgrade_all_t state
+ *  @param i Index of the upgrade
+ *  @param downloaded 0 if the download succeeded, -1 if it failed
+ */
+static void upgrade_staged(upgrade_all_t *state, int i, int downloaded) {
+  upgrade_entry_t *upgrade = &state->upgrades[i];
+  upgrade_result_t *result = &state->results[i];
+
+  const char *error = stage_finish(&result->stage, downloaded);
+  if (error != NULL) {
+    if (!state->json_output) {
+      printf("%s: FAILED: %s\n", upgrade->name, error);
+    }
+    result->error = strdup(error);
+    state->fail_count++;
+    return;
+  }
+
+  if (!state->json_output) {
+    printf("Installing %s %s%s...\n", upgrade->name, upgrade->available,
+           result->stage.cached ? " (cached)"
+           : result->stage.delta ? " (delta)" : "");
+  }
+  fflush(stdout);
+
+  // Remove old version and install the new one (silently)
+  FILE *devnull = fopen("/dev/null", "w");
+  FILE *orig_stdout = stdout;
+  FILE *orig_stderr = stderr;
+  if (devnull) {
+    stdout = devnull;
+    stderr = devnull;
+  }
+
+  pkg_remove(upgrade->name, 0, state->db);
+  int install_result = pkg_install_from_dir(result->stage.dir, 0, state->db,
+                                            1);
+  result->stage.dir = NULL;
+
+  if (devnull) {
+    stdout = orig_stdout;
+    stderr = orig_stderr;
+    fclose(devnull);
+  }
+
+  if (install_result == 0) {
+    result->success = 1;
+    state->success_count++;
+    if (!state->json_output) {
+      printf("  Upgraded %s: %s \u2192 %s\n",
+             upgrade->name, upgrade->installed, upgrade->available);
+    }
+  } else {
+    result->error = strdup("installation failed");
+    state->fail_count++;
+    if (!state->json_output) {
+      printf("  FAILED: installation error\n");
+    }
+  }
+  fflush(stdout);
+}
+
+
+/** Replaces an installed package with its download, for pkg upgrade.
+ *  @param index Index of the download
+ *  @param downloaded 0 if the download succeeded, -1 if it failed
+ *  @param ctx The upgrade_all_t state
+ */
+static void upgrade_downloaded(int index, int downloaded, void *ctx) {
+  upgrade_all_t *state = ctx;
+  upgrade_staged(state, state->slots[index], downloaded);
+}
+
+
+/** A delta downloaded into memory, for pkg upgrade. */
+typedef struct {
+  unsigned char *data;
+  size_t len;
+  size_t capacity;
+  PkgCacheWriter *check;  // Verifies the delta, or NULL
+  int result;             // Outcome of the download
+} delta_download_t;
+
+
+/** Download sink that verifies and buffers a delta.
+ *  @param data Bytes received
+ *  @param len Number of bytes
+ *  @param ctx The delta_download_t
+ *  @return 0 to go on, -1 to abort the download
+ */
+static int delta_sink(const void *data, size_t len, void *ctx) {
+  delta_download_t *d = ctx;
+  if (d->check && pkg_cache_writer_write(d->check, data, len) != 0) {
+    return -1;
+  }
+  if (d->len + len > d->capacity) {
+    size_t capacity = d->capacity ? d->capacity : 64 * 1024;
+    while (capacity < d->len + len) capacity *= 2;
+    unsigned char *grown = realloc(d->data, capacity);
+    if (grown == NULL) return -1;
+    d->data = grown;
+    d->capacity = capacity;
+  }
+  memcpy(d->data + d->len, data, len);
+  d->len += len;
+  return 0;
+}
+
+
+/** Records the outcome of a delta download.
+ *  @param index Index of the download
+ *  @param result 0 if it succeeded, -1 if it failed
+ *  @param ctx Array of delta_download_t
+ */
+static void delta_downloaded(int index, int result, void *ctx) {
+  delta_download_t *deltas = ctx;
+  deltas[index].result = result;
+}
+
+
+/** Says whether an installed package came from a prebuilt tarball.
+ *  @param dir Installed package directory
+ *  @return 1 if it is this platform's prebuilt package, 0 if it was built
+ *          from source, -1 if it is another platform's or unreadable
+ */
+static int installed_prebuilt(const char *dir) {
+  size_t path_len = strlen(dir) + strlen("/pkg.json") + 1;
+  char *path = malloc(path_len);
+  if (path == NULL) return -1;
+  snprintf(path, path_len, "%s/pkg.json", dir);
+  PkgManifest *m = pkg_manifest_load(path);
+  free(path);
+  if (m == NULL) return -1;
+
+  char platform[128];
+  int prebuilt = 0;
+  if (m->platform != NULL) {
+    prebuilt = pkg_platform(platform, sizeof(platform)) == 0 &&
+               strcmp(m->platform, platform) == 0 ? 1 : -1;
+  }
+  pkg_manifest_free(m);
+  return prebuilt;
+}
+
+
+/** Rebuilds updates from deltas against their installed versions and
+ *  installs them, downloading the deltas in parallel. Updates whose delta
+ *  fails to download, verify or apply are left for the full tarball.
+ *  @param state The upgrade_all_t state
+ *  @param count Number of upgrades
+ */
+static void upgrade_from_deltas(upgrade_all_t *state, int count) {
+  delta_download_t *deltas = calloc((size_t)count, sizeof(delta_download_t));
+  PkgDownload *downloads = calloc((size_t)count, sizeof(PkgDownload));
+  int *slots = calloc((size_t)count, sizeof(int));
+  int download_count = 0;
+
+  for (int i = 0; deltas && downloads && slots && i < count; i++) {
+    upgrade_entry_t *upgrade = &state->upgrades[i];
+    if (upgrade->delta_url == NULL) continue;
+    // A cached tarball needs no download at all
+    if (upgrade->sha256 && pkg_cache_has(upgrade->sha256)) continue;
+
+    delta_download_t *d = &deltas[download_count];
+    if (upgrade->delta_sha256) {
+      d->check = pkg_cache_writer_new(upgrade->delta_sha256, false);
+      if (d->check == NULL) continue;
+    }
+    if (!state->json_output) {
+      printf("Downloading %s %s \u2192 %s delta...\n", upgrade->name,
+             upgrade->installed, upgrade->available);
+    }
+    downloads[download_count] = (PkgDownload){
+      .url = upgrade->delta_url, .sink = delta_sink, .ctx = d
+    };
+    slots[download_count++] = i;
+  }
+  fflush(stdout);
+
+  if (download_count > 0) {
+    pkg_registry_download_all(downloads, download_count,
+                              PKG_DOWNLOAD_PARALLEL, delta_downloaded,
+                              deltas);
+  }
+
+  for (int k = 0; k < download_count; k++) {
+    int i = slots[k];
+    upgrade_entry_t *upgrade = &state->upgrades[i];
+    delta_download_t *d = &deltas[k];
+    int ok = d->result == 0;
+    if (d->check && pkg_cache_writer_finish(d->check, ok) != 0) ok = 0;
+
+    char *dir = ok ? make_staging_dir() : NULL;
+    if (dir && pkg_delta_apply(d->data, d->len, upgrade->installed_dir,
+                               dir) == 0) {
+      state->results[i].stage = (staged_download_t){.dir = dir, .delta = 1};
+      upgrade_staged(state, i, 0);
+    } else {
+      if (dir) {
+        pkg_remove_dir_recursive(dir);
+        free(dir);
+      }
+      if (!state->json_output) {
+        printf("%s: delta %s, downloading the full package\n",
+               upgrade->name, ok ? "does not apply" : "download failed");
+      }
+    }
+    free(d->data);
+  }
+
+  free(deltas);
+  free(downloads);
+  free(slots);
+}
+
+
 /** Upgrades all packages with available updates.
  *  @param json_output Whether to output in JSON format
  *  @return 0 on success, 1 on error
@@ -1476,13 +2345,6 @@ static int pkg_upgrade(int json_output) {
   }
 
   // Collect packages that need updating and up-to-date packages
-  typedef struct {
-    char *name;
-    char *installed;
-    char *available;
-    char *download_url;
-  } upgrade_entry_t;
-
   upgrade_entry_t *upgrades = NULL;
   int upgrade_count = 0;
   int upgrade_capacity = 0;
@@ -1491,10 +2353,19 @@ static int pkg_upgrade(int json_output) {
   int up_to_date_count = 0;
   int up_to_date_capacity = 0;
 
-  for (int i = 0; i < db->count; i++) {
+  // One request for the whole registry rather than one per package
+  PkgRegistryList *registry = pkg_registry_fetch_all();
+
+  for (int i = 0; registry && i < db->count; i++) {
     PkgDbEntry *entry = &db->entries[i];
 
-    PkgRegistryEntry *reg_entry = pkg_registry_fetch_package(entry->name);
+    PkgRegistryEntry *reg_entry = NULL;
+    for (int j = 0; j < registry->count && !reg_entry; j++) {
+      if (registry->entries[j].name &&
+          strcmp(registry->entries[j].name, entry->name) == 0) {
+        reg_entry = &registry->entries[j];
+      }
+    }
     if (reg_entry == NULL) continue;
 
     int cmp = pkg_version_compare(entry->version, reg_entry->latest_version);
@@ -1507,9 +2378,33 @@ static int pkg_upgrade(int json_output) {
       upgrades[upgrade_count].name = strdup(entry->name);
       upgrades[upgrade_count].installed = strdup(entry->version);
       upgrades[upgrade_count].available = strdup(reg_entry->latest_version);
-      upgrades[upgrade_count].download_url = reg_entry->download_url ?
-                                             strdup(reg_entry->download_url) :
-                                             NULL;
+      const char *url = pkg_registry_entry_url(reg_entry);
+      const char *sha256 = pkg_registry_entry_sha256(reg_entry);
+      upgrades[upgrade_count].download_url = url ? strdup(url) : NULL;
+      upgrades[upgrade_count].sha256 = sha256 ? strdup(sha256) : NULL;
+
+      // A delta is usable if it was made from the kind of tarball, source
+      // or prebuilt, the installed version came from
+      char *dir = NULL;
+      char *pkgs_dir = pkg_get_pkgs_dir();
+      if (pkgs_dir) {
+        size_t dir_len = strlen(pkgs_dir) + strlen(entry->name)
+                         + strlen(entry->version) + 3;
+        dir = malloc(dir_len);
+        if (dir) {
+          snprintf(dir, dir_len, "%s/%s-%s", pkgs_dir, entry->name,
+                   entry->version);
+        }
+      }
+      free(pkgs_dir);
+      int prebuilt = dir ? installed_prebuilt(dir) : -1;
+      const PkgRegistryDelta *delta = prebuilt >= 0
+        ? pkg_registry_entry_delta(reg_entry, entry->version, prebuilt == 1)
+        : NULL;
+      upgrades[upgrade_count].installed_dir = dir;
+      upgrades[upgrade_count].delta_url = delta ? strdup(delta->url) : NULL;
+      upgrades[upgrade_count].delta_sha256 =
+        delta && delta->sha256 ? strdup(delta->sha256) : NULL;
       upgrade_count++;
     } else {
       // Track up-to-date packages
@@ -1522,13 +2417,12 @@ static int pkg_upgrade(int json_output) {
       up_to_date[up_to_date_count] = strdup(entry->name);
       up_to_date_count++;
     }
-
-    pkg_registry_entry_free(reg_entry);
   }
 
-  pkg_db_free(db);
+  pkg_registry_list_free(registry);
 
   if (upgrade_count == 0) {
+    pkg_db_free(db);
     if (json_output) {
       printf("{\"status\": \"ok\", \"upgraded\": [], \"failed\": [], "
              "\"up_to_date\": [");
@@ -1551,18 +2445,39 @@ static int pkg_upgrade(int json_output) {
   }
 
   // Perform upgrades
-  typedef struct {
-    char *name;
-    char *from;
-    char *to;
-    int success;
-    char *error;
-  } upgrade_result_t;
-
   upgrade_result_t *results = malloc((size_t)upgrade_count
                                      * sizeof(upgrade_result_t));
-  int success_count = 0;
-  int fail_count = 0;
+  PkgDownload *downloads = malloc((size_t)upgrade_count
+                                  * sizeof(PkgDownload));
+  upgrade_all_t state = {
+    .upgrades = upgrades,
+    .results = results,
+    .slots = malloc((size_t)upgrade_count * sizeof(int)),
+    .db = db,
+    .json_output = json_output
+  };
+  if (results == NULL || downloads == NULL || state.slots == NULL) {
+    fprintf(stderr, "pkg upgrade: out of memory\n");
+    pkg_db_free(db);
+    for (int i = 0; i < upgrade_count; i++) {
+      free(upgrades[i].name);
+      free(upgrades[i].installed);
+      free(upgrades[i].available);
+      free(upgrades[i].download_url);
+      free(upgrades[i].sha256);
+      free(upgrades[i].installed_dir);
+      free(upgrades[i].delta_url);
+      free(upgrades[i].delta_sha256);
+    }
+    free(upgrades);
+    free(results);
+    free(downloads);
+    free(state.slots);
+    for (int i = 0; i < up_to_date_count; i++) free(up_to_date[i]);
+    free(up_to_date);
+    return 1;
+  }
+  int download_count = 0;
 
   for (int i = 0; i < upgrade_count; i++) {
     results[i].name = strdup(upgrades[i].name);
@@ -1570,96 +2485,67 @@ static int pkg_upgrade(int json_output) {
     results[i].to = strdup(upgrades[i].available);
     results[i].success = 0;
     results[i].error = NULL;
+    results[i].stage = (staged_download_t){0};
+  }
 
-    if (!json_output) {
-      printf("Downloading %s %s...\n", upgrades[i].name, upgrades[i].available);
-    }
+  // Fetch only what changed where the registry has a delta from the
+  // installed version
+  upgrade_from_deltas(&state, upgrade_count);
+
+  for (int i = 0; i < upgrade_count; i++) {
+    if (results[i].stage.delta) continue;
 
     if (!upgrades[i].download_url) {
       if (!json_output) {
-        printf("  FAILED: no download URL\n");
+        printf("%s: FAILED: no download URL\n", upgrades[i].name);
       }
       results[i].error = strdup("no download URL");
-      fail_count++;
+      state.fail_count++;
       continue;
     }
 
-    // Download to temp file
-    char temp_path[] = "/tmp/pkg-upgrade-XXXXXX.tar.gz";
-    int fd = mkstemps(temp_path, 7);
-    if (fd < 0) {
-      if (!json_output) {
-        printf("  FAILED: could not create temp file\n");
-      }
-      results[i].error = strdup("temp file creation failed");
-      fail_count++;
+    // Upgrade from the cache, or extract straight into a staging
+    // directory as it downloads
+    if (stage_from_cache(&results[i].stage, upgrades[i].sha256) == 0) {
+      upgrade_staged(&state, i, 0);
       continue;
     }
-    close(fd);
-
-    if (pkg_registry_download(upgrades[i].download_url, temp_path) != 0) {
+    if (stage_begin(&results[i].stage, upgrades[i].sha256, 1) != 0) {
       if (!json_output) {
-        printf("  FAILED: download error\n");
+        printf("%s: FAILED: could not create staging directory\n",
+               upgrades[i].name);
       }
-      results[i].error = strdup("download failed");
-      remove(temp_path);
-      fail_count++;
+      results[i].error = strdup("staging directory creation failed");
+      state.fail_count++;
       continue;
     }
 
     if (!json_output) {
-      printf("Installing %s %s...\n", upgrades[i].name, upgrades[i].available);
-    }
-
-    // Remove old version (silently)
-    FILE *devnull = fopen("/dev/null", "w");
-    FILE *orig_stdout = stdout;
-    FILE *orig_stderr = stderr;
-    if (devnull) {
-      stdout = devnull;
-      stderr = devnull;
-    }
-
-    pkg_remove(upgrades[i].name, 0);
-
-    if (devnull) {
-      stdout = orig_stdout;
-      stderr = orig_stderr;
-      fclose(devnull);
-    }
-
-    // Install new version (silently)
-    devnull = fopen("/dev/null", "w");
-    if (devnull) {
-      stdout = devnull;
-      stderr = devnull;
-    }
-
-    int install_result = pkg_install(temp_path, 0);
-
-    if (devnull) {
-      stdout = orig_stdout;
-      stderr = orig_stderr;
-      fclose(devnull);
+      printf("Downloading %s %s...\n", upgrades[i].name,
+             upgrades[i].available);
     }
+    downloads[download_count].url = upgrades[i].download_url;
+    downloads[download_count].sink = stage_sink;
+    downloads[download_count].ctx = &results[i].stage;
+    state.slots[download_count] = i;
+    download_count++;
+  }
 
-    remove(temp_path);
+  fflush(stdout);
+  download_and_install(downloads, download_count, upgrade_downloaded,
+                       &state);
+  free(downloads);
+  free(state.slots);
 
-    if (install_result == 0) {
-      results[i].success = 1;
-      success_count++;
-      if (!json_output) {
-        printf("  Upgraded %s: %s \u2192 %s\n",
-               upgrades[i].name, upgrades[i].installed, upgrades[i].available);
-      }
-    } else {
-      results[i].error = strdup("installation failed");
-      fail_count++;
-      if (!json_output) {
-        printf("  FAILED: installation error\n");
-      }
-    }
+  // Record every removal and install in one write
+  int save_failed = pkg_db_save(db) != 0;
+  if (save_failed) {
+    fprintf(stderr, "pkg upgrade: failed to update package database\n");
   }
+  pkg_db_free(db);
+
+  int success_count = state.success_count;
+  int fail_count = state.fail_count;
 
   // Output results
   if (json_output) {
@@ -1706,17 +2592,86 @@ static int pkg_upgrade(int json_output) {
     free(upgrades[i].installed);
     free(upgrades[i].available);
     free(upgrades[i].download_url);
+    free(upgrades[i].sha256);
+    free(upgrades[i].installed_dir);
+    free(upgrades[i].delta_url);
+    free(upgrades[i].delta_sha256);
     free(results[i].name);
     free(results[i].from);
     free(results[i].to);
     free(results[i].error);
+    if (results[i].stage.stream) {
+      stage_finish(&results[i].stage, -1);
+    }
   }
   free(upgrades);
   free(results);
   for (int i = 0; i < up_to_date_count; i++) free(up_to_date[i]);
   free(up_to_date);
 
-  return fail_count > 0 ? 1 : 0;
+  return fail_count > 0 || save_failed ? 1 : 0;
+}
+
+
+/** Describes the outcome of a build for pkg compile's progress lines.
+ *  @param job Settled build
+ *  @return Status word
+ */
+static const char *compile_status_word(const PkgMakeJob *job) {
+  switch (job->status) {
+    case PKG_MAKE_OK:
+      return "ok";
+    case PKG_MAKE_UP_TO_DATE:
+      return "up to date";
+    default:
+      return "FAILED";
+  }
+}
+
+
+/** Reports a settled build; the output of failed ones goes to stderr.
+ *  @param job Settled build
+ *  @param json_output Whether to output in JSON format
+ *  @param verbose Whether to print a progress line
+ */
+static void report_compile(const PkgMakeJob *job, int json_output,
+                           int verbose) {
+  if (job->status == PKG_MAKE_NO_MAKEFILE) {
+    return;
+  }
+  if (verbose && !json_output) {
+    printf("Compiling %s... %s\n", job->name, compile_status_word(job));
+    fflush(stdout);
+  }
+  if (job->log != NULL) {
+    fputs(job->log, stderr);
+  }
+}
+
+
+/** Progress callback of pkg compile for several packages.
+ *  @param job Settled build
+ *  @param ctx Pointer to the json_output flag
+ */
+static void compile_done(PkgMakeJob *job, void *ctx) {
+  report_compile(job, *(int *)ctx, 1);
+}
+
+
+/** Maps a settled build to compile_package_dir's return value.
+ *  @param job Settled build
+ *  @return 0 on success, -1 if no Makefile, >0 on compilation failure
+ */
+static int compile_result(const PkgMakeJob *job) {
+  switch (job->status) {
+    case PKG_MAKE_OK:
+    case PKG_MAKE_UP_TO_DATE:
+      return 0;
+    case PKG_MAKE_NO_MAKEFILE:
+      return -1;
+    default:
+      return job->exit_code > 0 ? job->exit_code : 1;
+  }
 }
 
 
@@ -1725,31 +2680,99 @@ static int pkg_upgrade(int json_output) {
  *  @param dir Directory containing Makefile
  *  @param json_output Whether to output in JSON format
  *  @param verbose Whether to print verbose output
+ *  @param force Whether to build even if the sources are unchanged
  *  @return 0 on success, -1 if no Makefile, >0 on compilation failure
  */
 static int compile_package_dir(const char *name, const char *dir,
-                               int json_output, int verbose) {
-  struct stat st;
-  char makefile_path[4096];
-  snprintf(makefile_path, sizeof(makefile_path), "%s/Makefile", dir);
+                               int json_output, int verbose, int force) {
+  PkgMakeJob job = {.name = name, .dir = dir, .force = force};
+  pkg_make_run(&job, 1, NULL, NULL);
+  report_compile(&job, json_output, verbose);
+  free(job.log);
+  return compile_result(&job);
+}
 
-  if (stat(makefile_path, &st) != 0) {
-    return -1;  // No Makefile
-  }
 
-  if (verbose && !json_output) {
-    printf("Compiling %s... ", name);
-    fflush(stdout);
+/** Implementation of build_installed.
+ *  @param db Database recording the installs
+ *  @param names Names of the installed packages
+ *  @param count Number of names
+ *  @param json_output Whether to output in JSON format
+ *  @param failed Set to 1 for each package whose build failed, else 0
+ *  @return Number of failed builds
+ */
+static int build_installed(PkgDb *db, char **names, int count,
+                           int json_output, int *failed) {
+  char *pkgs_dir = pkg_get_pkgs_dir();
+  PkgMakeJob *jobs = calloc((size_t)count, sizeof(PkgMakeJob));
+  if (pkgs_dir == NULL || jobs == NULL) {
+    free(pkgs_dir);
+    free(jobs);
+    return 0;
   }
 
-  char *make_argv[] = {"make", "-C", (char *)dir, NULL};
-  int result = pkg_run_command(make_argv);
+  PkgManifest **manifests = calloc((size_t)count, sizeof(PkgManifest *));
+  for (int i = 0; i < count; i++) {
+    PkgDbEntry *entry = pkg_db_find(db, names[i]);
+    char *dir = NULL;
+    if (entry != NULL) {
+      size_t len = strlen(pkgs_dir) + strlen(entry->name)
+                   + strlen(entry->version) + 3;
+      dir = malloc(len);
+      if (dir != NULL) {
+        snprintf(dir, len, "%s/%s-%s", pkgs_dir, entry->name, entry->version);
+      }
+    }
+    jobs[i].name = names[i];
+    jobs[i].dir = dir != NULL ? dir : "";
+    jobs[i].force = true;
 
-  if (verbose && !json_output) {
-    printf("%s\n", result == 0 ? "ok" : "FAILED");
+    char manifest_path[4096];
+    snprintf(manifest_path, sizeof(manifest_path), "%s/pkg.json",
+             jobs[i].dir);
+    if (manifests != NULL && dir != NULL) {
+      manifests[i] = pkg_manifest_load(manifest_path);
+    }
   }
+  free(pkgs_dir);
 
-  return result;
+  // A dependency built in this run is waited for, one installed before
+  // needs nothing, and any other keeps the package unbuilt
+  for (int i = 0; manifests != NULL && i < count; i++) {
+    PkgManifest *m = manifests[i];
+    if (m == NULL || m->dependencies_count == 0) continue;
+    int *deps = malloc((size_t)m->dependencies_count * sizeof(int));
+    if (deps == NULL) continue;
+    int deps_count = 0;
+    for (int d = 0; d < m->dependencies_count; d++) {
+      int dep = -1;
+      for (int j = 0; j < count && dep < 0; j++) {
+        if (strcmp(names[j], m->dependencies[d]) == 0) dep = j;
+      }
+      if (dep >= 0 || pkg_db_find(db, m->dependencies[d]) == NULL) {
+        deps[deps_count++] = dep;
+      }
+    }
+    jobs[i].deps = deps;
+    jobs[i].deps_count = deps_count;
+  }
+
+  int failed_count = pkg_make_run(jobs, count, compile_done, &json_output);
+
+  for (int i = 0; i < count; i++) {
+    failed[i] = jobs[i].status == PKG_MAKE_FAILED;
+    if (*jobs[i].dir != '\0') {
+      free((char *)jobs[i].dir);
+    }
+    free((int *)jobs[i].deps);
+    free(jobs[i].log);
+    if (manifests != NULL) {
+      pkg_manifest_free(manifests[i]);
+    }
+  }
+  free(manifests);
+  free(jobs);
+  return failed_count;
 }
 
 
@@ -1833,7 +2856,7 @@ static int pkg_compile(const char *app_name, int json_output) {
     // Try installed package first
     char *pkg_dir = get_installed_pkg_dir(app_name);
     if (pkg_dir != NULL) {
-      int result = compile_package_dir(app_name, pkg_dir, json_output, 1);
+      int result = compile_package_dir(app_name, pkg_dir, json_output, 1, 0);
       if (result >= 0) {
         // Found and attempted compile
         if (result == 0) {
@@ -1885,7 +2908,7 @@ static int pkg_compile(const char *app_name, int json_output) {
       }
     }
 
-    int result = compile_package_dir(app_name, apps_dir, json_output, 1);
+    int result = compile_package_dir(app_name, apps_dir, json_output, 1, 0);
     if (result < 0) {
       if (json_output) {
         printf("{\"status\": \"error\", "
@@ -1919,34 +2942,49 @@ static int pkg_compile(const char *app_name, int json_output) {
 
   char **results_names = NULL;
   char **results_sources = NULL;
-  int *results_status = NULL;
+  PkgMakeStatus *results_status = NULL;
   int results_count = 0;
   int results_capacity = 0;
 
-  // First, compile installed packages
+  // Packages to build side by side, installed ones first
+  PkgMakeJob *jobs = NULL;
+  int job_count = 0;
+
   PkgDb *db = pkg_db_load();
   if (db != NULL && db->count > 0) {
-    if (!json_output) {
-      printf("Compiling installed packages...\n");
-    }
-
-    for (int i = 0; i < db->count; i++) {
+    jobs = calloc((size_t)db->count, sizeof(PkgMakeJob));
+    for (int i = 0; jobs != NULL && i < db->count; i++) {
       char *pkg_dir = get_installed_pkg_dir(db->entries[i].name);
       if (pkg_dir == NULL) continue;
+      jobs[job_count].name = strdup(db->entries[i].name);
+      jobs[job_count].dir = pkg_dir;
+      job_count++;
+    }
+  }
+  pkg_db_free(db);
+  const char *source = "installed";
+
+  if (job_count > 0 && !json_output) {
+    printf("Compiling installed packages...\n");
+  }
+  fflush(stdout);
+  pkg_make_run(jobs, job_count, compile_done, &json_output);
 
-      int result = compile_package_dir(db->entries[i].name, pkg_dir,
-                                       json_output, 1);
+  for (int round = 0; round < 2; round++) {
+    for (int j = 0; j < job_count; j++) {
+      int result = compile_result(&jobs[j]);
       if (result < 0) {
         // No Makefile, skip
-        skipped_count++;
-        free(pkg_dir);
+        if (round == 0) skipped_count++;
         continue;
       }
 
       total_count++;
       if (result == 0) {
         success_count++;
-        update_pkg_symlink(db->entries[i].name, pkg_dir);
+        if (round == 0) {
+          update_pkg_symlink(jobs[j].name, jobs[j].dir);
+        }
       }
 
       if (json_output) {
@@ -1957,75 +2995,72 @@ static int pkg_compile(const char *app_name, int json_output) {
           results_sources = realloc(results_sources,
                                     (size_t)results_capacity * sizeof(char *));
           results_status = realloc(results_status,
-                                   (size_t)results_capacity * sizeof(int));
+                                   (size_t)results_capacity
+                                   * sizeof(PkgMakeStatus));
         }
-        results_names[results_count] = strdup(db->entries[i].name);
-        results_sources[results_count] = strdup("installed");
-        results_status[results_count] = result;
+        results_names[results_count] = strdup(jobs[j].name);
+        results_sources[results_count] = strdup(source);
+        results_status[results_count] = jobs[j].status;
         results_count++;
       }
+    }
 
-      free(pkg_dir);
+    for (int j = 0; j < job_count; j++) {
+      free((char *)jobs[j].name);
+      free((char *)jobs[j].dir);
+      free(jobs[j].log);
     }
+    free(jobs);
+    jobs = NULL;
+    job_count = 0;
 
-    pkg_db_free(db);
-  }
+    // If no installed packages were compiled, try src/apps
+    if (round > 0 || total_count > 0) {
+      break;
+    }
 
-  // If no installed packages were compiled, try src/apps
-  if (total_count == 0) {
     char apps_dir[8192];
     char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+      break;
+    }
+    snprintf(apps_dir, sizeof(apps_dir), "%s/src/apps", cwd);
+    if (stat(apps_dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+      snprintf(apps_dir, sizeof(apps_dir), "../src/apps");
+    }
 
-    if (getcwd(cwd, sizeof(cwd)) != NULL) {
-      snprintf(apps_dir, sizeof(apps_dir), "%s/src/apps", cwd);
-      if (stat(apps_dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
-        snprintf(apps_dir, sizeof(apps_dir), "../src/apps");
+    DIR *dir = opendir(apps_dir);
+    if (dir == NULL) {
+      break;
+    }
+    int job_capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+      if (entry->d_name[0] == '.') continue;
+
+      char app_dir[8448];
+      snprintf(app_dir, sizeof(app_dir), "%s/%s", apps_dir, entry->d_name);
+      if (stat(app_dir, &st) != 0 || !S_ISDIR(st.st_mode)) continue;
+
+      if (job_count >= job_capacity) {
+        job_capacity = job_capacity == 0 ? 16 : job_capacity * 2;
+        PkgMakeJob *grown = realloc(jobs,
+                                    (size_t)job_capacity * sizeof(PkgMakeJob));
+        if (grown == NULL) break;
+        jobs = grown;
       }
+      jobs[job_count] = (PkgMakeJob){.name = strdup(entry->d_name),
+                                     .dir = strdup(app_dir)};
+      job_count++;
+    }
+    closedir(dir);
+    source = "src/apps";
 
-      DIR *dir = opendir(apps_dir);
-      if (dir != NULL) {
-        if (!json_output) {
-          printf("Compiling apps from source...\n");
-        }
-
-        struct dirent *entry;
-        while ((entry = readdir(dir)) != NULL) {
-          if (entry->d_name[0] == '.') continue;
-
-          char app_dir[8448];
-          snprintf(app_dir, sizeof(app_dir), "%s/%s", apps_dir, entry->d_name);
-
-          if (stat(app_dir, &st) != 0 || !S_ISDIR(st.st_mode)) continue;
-
-          int result = compile_package_dir(entry->d_name, app_dir,
-                                           json_output, 1);
-          if (result < 0) continue;  // No Makefile
-
-          total_count++;
-          if (result == 0) {
-            success_count++;
-          }
-
-          if (json_output) {
-            if (results_count >= results_capacity) {
-              results_capacity = results_capacity == 0 ? 16 :
-                                 results_capacity * 2;
-              results_names = realloc(results_names,
-                                      (size_t)results_capacity * sizeof(char *));
-              results_sources = realloc(results_sources,
-                                        (size_t)results_capacity * sizeof(char *));
-              results_status = realloc(results_status,
-                                       (size_t)results_capacity * sizeof(int));
-            }
-            results_names[results_count] = strdup(entry->d_name);
-            results_sources[results_count] = strdup("src/apps");
-            results_status[results_count] = result;
-            results_count++;
-          }
-        }
-        closedir(dir);
-      }
+    if (!json_output) {
+      printf("Compiling apps from source...\n");
     }
+    fflush(stdout);
+    pkg_make_run(jobs, job_count, compile_done, &json_output);
   }
 
   if (total_count == 0) {
@@ -2043,9 +3078,13 @@ static int pkg_compile(const char *app_name, int json_output) {
            success_count == total_count ? "ok" : "partial");
     for (int i = 0; i < results_count; i++) {
       if (i > 0) printf(", ");
-      printf("{\"name\": \"%s\", \"source\": \"%s\", \"status\": \"%s\"}",
+      printf("{\"name\": \"%s\", \"source\": \"%s\", \"status\": \"%s\"",
              results_names[i], results_sources[i],
-             results_status[i] == 0 ? "ok" : "error");
+             results_status[i] == PKG_MAKE_FAILED ? "error" : "ok");
+      if (results_status[i] == PKG_MAKE_UP_TO_DATE) {
+        printf(", \"up_to_date\": true");
+      }
+      printf("}");
       free(results_names[i]);
       free(results_sources[i]);
     }
@@ -2095,6 +3134,13 @@ static int pkg_run(int argc, char **argv) {
   }
 
   int json_output = args.json->count > 0;
+  int segments = args.segments->count > 0 ? args.segments->ival[0] : 1;
+  if (segments < 1 || segments > JBOX_HTTP_MAX_SEGMENTS) {
+    fprintf(stderr, "pkg: --segments must be between 1 and %d\n",
+            JBOX_HTTP_MAX_SEGMENTS);
+    cleanup_pkg_argtable(&args);
+    return 1;
+  }
   const char *subcmd_str = args.subcmd->sval[0];
   pkg_subcommand_t subcmd = parse_subcommand(subcmd_str);
 
@@ -2120,14 +3166,19 @@ static int pkg_run(int argc, char **argv) {
       result = pkg_search(first_arg, json_output);
       break;
     case PKG_CMD_INSTALL:
-      result = pkg_install(first_arg, json_output);
+      result = pkg_install(first_arg, json_output, segments);
       break;
     case PKG_CMD_REMOVE:
-      result = pkg_remove(first_arg, json_output);
+      result = pkg_remove(first_arg, json_output, NULL);
       break;
     case PKG_CMD_BUILD:
       result = pkg_build(first_arg, second_arg, json_output);
       break;
+    case PKG_CMD_DELTA:
+      result = pkg_delta(first_arg, second_arg,
+                         args.args->count > 2 ? args.args->sval[2] : NULL,
+                         json_output);
+      break;
     case PKG_CMD_CHECK_UPDATE:
       result = pkg_check_update(json_output);
       break;
@@ -2157,7 +3208,8 @@ const jshell_cmd_spec_t cmd_pkg_spec = {
                "for the jshell.",
   .type = CMD_EXTERNAL,
   .run = pkg_run,
-  .print_usage = pkg_print_usage
+  .print_usage = pkg_print_usage,
+  .describe_args = pkg_describe_args
 };
 
 
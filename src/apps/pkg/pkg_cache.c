@@ -0,0 +1,228 @@
+/** @file pkg_cache.c
+ *  @brief Content-addressed cache of package tarballs.
+ *
+ *  Tarballs are hashed with SHA-256 as they stream from the registry,
+ *  and written to a temporary file in the cache directory next to their
+ *  final name. Only once the whole download matched the digest is the
+ *  file renamed into place, so a cache entry is always complete and
+ *  correct, and concurrent installs never see a partial one.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "pkg_cache.h"
+#include "pkg_utils.h"
+#include "utils/jbox_hash.h"
+
+
+#define SHA256_HEX_LEN 64
+
+
+struct PkgCacheWriter {
+  jbox_sha256_t md;
+  char digest[SHA256_HEX_LEN + 1];  // Expected, lowercase
+  int fd;                           // Temporary file, or -1
+  char *tmp_path;
+  char *path;                       // Final name in the cache
+};
+
+
+/** Checks that a string is a hex SHA-256 digest.
+ *  @param s String to check
+ *  @return true if it is 64 hex digits
+ */
+bool pkg_cache_valid_digest(const char *s) {
+  if (s == NULL) return false;
+  size_t i = 0;
+  for (; s[i]; i++) {
+    if (!isxdigit((unsigned char)s[i])) return false;
+  }
+  return i == SHA256_HEX_LEN;
+}
+
+
+/** Builds the cache path of a digest.
+ *  @param sha256 Hex digest
+ *  @return Allocated path, or NULL on error. Caller must free.
+ */
+static char *entry_path(const char *sha256) {
+  if (!pkg_cache_valid_digest(sha256)) return NULL;
+
+  char *cache = pkg_get_cache_dir();
+  if (cache == NULL) return NULL;
+
+  size_t len = strlen(cache) + 1 + SHA256_HEX_LEN + strlen(".tar.gz") + 1;
+  char *path = malloc(len);
+  if (path != NULL) {
+    int n = snprintf(path, len, "%s/", cache);
+    for (int i = 0; i < SHA256_HEX_LEN; i++) {
+      path[n + i] = (char)tolower((unsigned char)sha256[i]);
+    }
+    strcpy(path + n + SHA256_HEX_LEN, ".tar.gz");
+  }
+  free(cache);
+  return path;
+}
+
+
+/** Checks whether a digest is cached.
+ *  @param sha256 Hex digest
+ *  @return true if a tarball with that digest is in the cache
+ */
+bool pkg_cache_has(const char *sha256) {
+  char *path = entry_path(sha256);
+  if (path == NULL) return false;
+  bool found = access(path, R_OK) == 0;
+  free(path);
+  return found;
+}
+
+
+/** Feeds a cached tarball to a sink.
+ *  @param sha256 Hex digest
+ *  @param sink Receives the tarball
+ *  @param ctx Passed to sink
+ *  @return 0 on success, -1 on error
+ */
+int pkg_cache_read(const char *sha256, PkgDownloadSink sink, void *ctx) {
+  char *path = entry_path(sha256);
+  if (path == NULL) return -1;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  free(path);
+  if (fd < 0) return -1;
+
+  char buf[64 * 1024];
+  ssize_t n;
+  int result = 0;
+  while ((n = read(fd, buf, sizeof(buf))) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      result = -1;
+      break;
+    }
+    if (sink(buf, (size_t)n, ctx) != 0) {
+      result = -1;
+      break;
+    }
+  }
+  close(fd);
+  return result;
+}
+
+
+/** Removes a tarball from the cache.
+ *  @param sha256 Hex digest
+ */
+void pkg_cache_evict(const char *sha256) {
+  char *path = entry_path(sha256);
+  if (path != NULL) {
+    unlink(path);
+    free(path);
+  }
+}
+
+
+/** Drops the temporary file of a writer.
+ *  @param w Writer
+ */
+static void discard_tmp(PkgCacheWriter *w) {
+  if (w->fd >= 0) {
+    close(w->fd);
+    w->fd = -1;
+    unlink(w->tmp_path);
+  }
+}
+
+
+/** Starts checking, and optionally caching, a tarball.
+ *  @param sha256 Expected hex digest
+ *  @param store Whether to add the tarball to the cache
+ *  @return New writer, or NULL on error
+ */
+PkgCacheWriter *pkg_cache_writer_new(const char *sha256, bool store) {
+  if (!pkg_cache_valid_digest(sha256)) return NULL;
+
+  PkgCacheWriter *w = calloc(1, sizeof(PkgCacheWriter));
+  if (w == NULL) return NULL;
+  w->fd = -1;
+  for (int i = 0; i < SHA256_HEX_LEN; i++) {
+    w->digest[i] = (char)tolower((unsigned char)sha256[i]);
+  }
+
+  jbox_sha256_init(&w->md);
+
+  // Not caching is no reason to fail the install
+  if (store && pkg_ensure_cache_dir() == 0) {
+    w->path = entry_path(sha256);
+    size_t len = w->path ? strlen(w->path) + strlen(".XXXXXX") + 1 : 0;
+    w->tmp_path = w->path ? malloc(len) : NULL;
+    if (w->tmp_path != NULL) {
+      snprintf(w->tmp_path, len, "%s.XXXXXX", w->path);
+      w->fd = mkostemp(w->tmp_path, O_CLOEXEC);
+    }
+  }
+  return w;
+}
+
+
+/** Hashes, and stores, the next part of a tarball.
+ *  A failure to store only means the tarball is not cached.
+ *  @param w Writer
+ *  @param data Bytes of the tarball
+ *  @param len Number of bytes
+ *  @return 0 on success, -1 if it could not be hashed
+ */
+int pkg_cache_writer_write(PkgCacheWriter *w, const void *data, size_t len) {
+  jbox_sha256_update(&w->md, data, len);
+
+  const char *p = data;
+  while (w->fd >= 0 && len > 0) {
+    ssize_t n = write(w->fd, p, len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) {
+      discard_tmp(w);
+      break;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+
+/** Checks the digest, commits a stored tarball and frees the writer.
+ *  @param w Writer, or NULL
+ *  @param complete Whether the whole tarball was written
+ *  @return 0 if the digest matched, -1 otherwise
+ */
+int pkg_cache_writer_finish(PkgCacheWriter *w, bool complete) {
+  if (w == NULL) return -1;
+
+  uint8_t md[JBOX_SHA256_LEN];
+  char hex[SHA256_HEX_LEN + 1];
+  jbox_sha256_final(&w->md, md);
+  jbox_hash_hex(md, sizeof(md), hex);
+  bool match = complete && strcmp(hex, w->digest) == 0;
+
+  if (w->fd >= 0 && match) {
+    int rc = close(w->fd);
+    w->fd = -1;
+    if (rc != 0 || rename(w->tmp_path, w->path) != 0) {
+      unlink(w->tmp_path);
+    }
+  }
+  discard_tmp(w);
+
+  free(w->tmp_path);
+  free(w->path);
+  free(w);
+  return match ? 0 : -1;
+}
@@ -0,0 +1,48 @@
+#ifndef PKG_CACHE_H
+#define PKG_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "pkg_registry.h"
+
+// Content-addressed cache of package tarballs (~/.jshell/cache)
+//
+// A tarball is stored under the SHA-256 the registry lists for it, as
+// <hex>.tar.gz, and only after its bytes were checked against that
+// digest. Packages with the same digest share one entry whatever their
+// name or version, and an entry never goes stale.
+
+// Whether s is a SHA-256 digest in hex (64 hex digits)
+bool pkg_cache_valid_digest(const char *s);
+
+// Whether a tarball with this digest is cached
+bool pkg_cache_has(const char *sha256);
+
+// Hand a cached tarball to sink, as a download would
+// Returns 0 on success, -1 if it is not cached or sink failed
+int pkg_cache_read(const char *sha256, PkgDownloadSink sink, void *ctx);
+
+// Drop a cached tarball, e.g. one found to be corrupt
+void pkg_cache_evict(const char *sha256);
+
+// Checks a tarball against its digest as it streams past, optionally
+// adding it to the cache
+typedef struct PkgCacheWriter PkgCacheWriter;
+
+// Start checking a tarball against sha256; with store set, its bytes are
+// also written to a temporary file in the cache
+// Returns NULL on error
+PkgCacheWriter *pkg_cache_writer_new(const char *sha256, bool store);
+
+// Take the next len bytes of the tarball; if they cannot be stored the
+// tarball is only checked, not cached
+// Returns 0 on success, -1 if hashing failed
+int pkg_cache_writer_write(PkgCacheWriter *w, const void *data, size_t len);
+
+// Check the digest and free the writer; if it matches and complete is
+// set, a stored tarball is moved into the cache, otherwise discarded
+// Returns 0 if the digest matched, -1 otherwise
+int pkg_cache_writer_finish(PkgCacheWriter *w, bool complete);
+
+#endif
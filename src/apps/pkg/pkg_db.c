@@ -1,49 +1,37 @@
 /** @file pkg_db.c
- *  @brief Package database management and JSON parsing.
+ *  @brief Package database management and JSON persistence.
+ *
+ *  Changes are remembered in the PkgDb until pkg_db_save appends them to
+ *  the journal in a single write, so a command that installs or removes
+ *  many packages touches the disk once, and the cost of a save does not
+ *  grow with the number of installed packages. Replaying a journal over a
+ *  snapshot that already contains its records leaves the snapshot's
+ *  contents unchanged, so a crash between writing a snapshot and removing
+ *  the journal is harmless.
+ *
+ *  Entries are found through a hash index on their names. Their strings
+ *  live in an arena owned by the database, so loading and freeing it costs
+ *  a few chunk allocations rather than one per field; strings replaced by
+ *  an update stay in the arena until the database is freed.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
-#include <ctype.h>
+#include <fcntl.h>
 #include <time.h>
+#include <unistd.h>
 #include <sys/stat.h>
 
 #include "pkg_db.h"
+#include "pkg_index.h"
 #include "pkg_utils.h"
-
-
-/** Skips whitespace characters in a string.
- *  @param s Input string
- *  @return Pointer to first non-whitespace character
- */
-static const char *skip_whitespace(const char *s);
-
-/** Parses a JSON string value.
- *  @param p Pointer to string pointer (updated after parse)
- *  @return Allocated string value, or NULL on error. Caller must free.
- */
-static char *parse_string(const char **p);
-
-/** Parses a JSON array of strings.
- *  @param p Pointer to string pointer (updated after parse)
- *  @param count Output parameter for array length
- *  @return Allocated array of strings, or NULL on error. Caller must free.
- */
-static char **parse_string_array(const char **p, int *count);
-
-/** Skips over a JSON value without parsing.
- *  @param s Input string
- *  @return Pointer past the JSON value
- */
-static const char *skip_value(const char *s);
-
-/** Parses a JSON integer value.
- *  @param p Pointer to string pointer (updated after parse)
- *  @return Parsed integer value
- */
-static int parse_int(const char **p);
+#include "utils/jbox_json.h"
 
 
 /** Generates an ISO 8601 timestamp string for current time.
@@ -66,14 +54,88 @@ char *pkg_db_get_timestamp(void) {
 }
 
 
-/** Frees memory associated with a package database entry.
- *  @param entry Pointer to entry to free (fields are freed, not the struct itself)
+struct PkgDbArenaChunk {
+  PkgDbArenaChunk *next;
+  size_t used;
+  size_t size;
+  max_align_t data[];
+};
+
+
+/** Allocates bytes from the database's arena, aligned for pointers.
+ *  @param db Pointer to database
+ *  @param size Bytes needed
+ *  @return Pointer to the bytes, or NULL on allocation failure
  */
-void pkg_db_entry_free(PkgDbEntry *entry) {
-  if (entry == NULL) {
-    return;
+static void *arena_alloc(PkgDb *db, size_t size) {
+  size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+  PkgDbArenaChunk *chunk = db->arena;
+
+  if (chunk == NULL || chunk->size - chunk->used < size) {
+    size_t chunk_size = size > PKG_DB_ARENA_CHUNK_SIZE
+                        ? size : PKG_DB_ARENA_CHUNK_SIZE;
+    chunk = malloc(sizeof(PkgDbArenaChunk) + chunk_size);
+    if (chunk == NULL) {
+      return NULL;
+    }
+    chunk->next = db->arena;
+    chunk->used = 0;
+    chunk->size = chunk_size;
+    db->arena = chunk;
   }
 
+  void *ptr = (char *)chunk->data + chunk->used;
+  chunk->used += size;
+  return ptr;
+}
+
+
+/** Copies a string into the database's arena.
+ *  @param db Pointer to database
+ *  @param str String to copy, or NULL
+ *  @param copy Receives the copy, or NULL if str is NULL
+ *  @return 0 on success, -1 on allocation failure
+ */
+static int arena_strdup(PkgDb *db, const char *str, char **copy) {
+  *copy = NULL;
+  if (str == NULL) {
+    return 0;
+  }
+  size_t len = strlen(str) + 1;
+  *copy = arena_alloc(db, len);
+  if (*copy == NULL) {
+    return -1;
+  }
+  memcpy(*copy, str, len);
+  return 0;
+}
+
+
+/** Copies a file list into the database's arena.
+ *  @param db Pointer to database
+ *  @param files Array of file paths
+ *  @param count Number of files
+ *  @param copy Receives the copied array
+ *  @return 0 on success, -1 on allocation failure
+ */
+static int arena_strv(PkgDb *db, char **files, int count, char ***copy) {
+  *copy = arena_alloc(db, (size_t)count * sizeof(char *));
+  if (*copy == NULL) {
+    return -1;
+  }
+  for (int i = 0; i < count; i++) {
+    if (arena_strdup(db, files[i], &(*copy)[i]) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+
+/** Frees an entry read from disk before it is copied into a database.
+ *  @param entry Entry whose fields were allocated individually
+ */
+static void free_parsed_entry(PkgDbEntry *entry) {
   free(entry->name);
   free(entry->version);
   free(entry->installed_at);
@@ -83,13 +145,18 @@ void pkg_db_entry_free(PkgDbEntry *entry) {
     free(entry->files[i]);
   }
   free(entry->files);
+  *entry = (PkgDbEntry){0};
+}
 
-  entry->name = NULL;
-  entry->version = NULL;
-  entry->installed_at = NULL;
-  entry->description = NULL;
-  entry->files = NULL;
-  entry->files_count = 0;
+
+/** Forgets the changes waiting to be written to the journal.
+ *  @param db Pointer to database
+ */
+static void clear_changes(PkgDb *db) {
+  for (int i = 0; i < db->changes_count; i++) {
+    free(db->changes[i].name);
+  }
+  db->changes_count = 0;
 }
 
 
@@ -101,35 +168,96 @@ void pkg_db_free(PkgDb *db) {
     return;
   }
 
-  for (int i = 0; i < db->count; i++) {
-    pkg_db_entry_free(&db->entries[i]);
+  PkgDbArenaChunk *chunk = db->arena;
+  while (chunk != NULL) {
+    PkgDbArenaChunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
   }
   free(db->entries);
+  free(db->slots);
+  clear_changes(db);
+  free(db->changes);
   free(db);
 }
 
 
+/** Hashes a package name (FNV-1a).
+ *  @param name Package name
+ *  @return Hash value
+ */
+static uint32_t hash_name(const char *name) {
+  uint32_t h = 2166136261u;
+  for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+    h = (h ^ *p) * 16777619u;
+  }
+  return h;
+}
+
+
+/** Finds the index slot of a name: the one holding it, or the free slot
+ *  where it belongs.
+ *  @param db Pointer to database with a non-empty index
+ *  @param name Package name
+ *  @return Slot position
+ */
+static int find_slot(const PkgDb *db, const char *name) {
+  int mask = db->slot_count - 1;
+  int pos = (int)(hash_name(name) & (uint32_t)mask);
+  while (db->slots[pos] != 0
+         && strcmp(db->entries[db->slots[pos] - 1].name, name) != 0) {
+    pos = (pos + 1) & mask;
+  }
+  return pos;
+}
+
+
+/** Rebuilds the hash index, grown to hold at least min_count entries.
+ *  @param db Pointer to database
+ *  @param min_count Number of entries the index must have room for
+ *  @return 0 on success, -1 on error
+ */
+static int rebuild_index(PkgDb *db, int min_count) {
+  int slot_count = 16;
+  while (slot_count < 2 * min_count) {
+    slot_count *= 2;
+  }
+  // The index only grows, so rebuilding it in place cannot fail
+  if (slot_count > db->slot_count) {
+    int *slots = malloc((size_t)slot_count * sizeof(int));
+    if (slots == NULL) {
+      return -1;
+    }
+    free(db->slots);
+    db->slots = slots;
+    db->slot_count = slot_count;
+  }
+
+  memset(db->slots, 0, (size_t)db->slot_count * sizeof(int));
+  for (int i = 0; i < db->count; i++) {
+    db->slots[find_slot(db, db->entries[i].name)] = i + 1;
+  }
+  return 0;
+}
+
+
 /** Finds a package entry in the database by name.
  *  @param db Pointer to database
  *  @param name Package name to search for
  *  @return Pointer to entry if found, NULL otherwise
  */
 PkgDbEntry *pkg_db_find(const PkgDb *db, const char *name) {
-  if (db == NULL || name == NULL) {
+  if (db == NULL || name == NULL || db->slot_count == 0) {
     return NULL;
   }
 
-  for (int i = 0; i < db->count; i++) {
-    if (strcmp(db->entries[i].name, name) == 0) {
-      return &db->entries[i];
-    }
-  }
-
-  return NULL;
+  int slot = db->slots[find_slot(db, name)];
+  return slot != 0 ? &db->entries[slot - 1] : NULL;
 }
 
 
-/** Ensures the database has capacity for at least one more entry.
+/** Ensures the database has room, in its entries and its index, for at
+ *  least one more entry.
  *  @param db Pointer to database
  *  @return 0 on success, -1 on error
  */
@@ -144,10 +272,117 @@ static int pkg_db_ensure_capacity(PkgDb *db) {
     db->entries = new_entries;
     db->capacity = new_capacity;
   }
+  if (2 * (db->count + 1) > db->slot_count) {
+    return rebuild_index(db, db->count + 1);
+  }
+  return 0;
+}
+
+
+/** Appends a named entry with no other fields and indexes it.
+ *  @param db Pointer to database
+ *  @param name Package name
+ *  @return The new entry, or NULL on error
+ */
+static PkgDbEntry *append_entry(PkgDb *db, const char *name) {
+  char *copy;
+  if (pkg_db_ensure_capacity(db) != 0 || arena_strdup(db, name, &copy) != 0) {
+    return NULL;
+  }
+
+  PkgDbEntry *entry = &db->entries[db->count];
+  *entry = (PkgDbEntry){.name = copy};
+  db->slots[find_slot(db, name)] = db->count + 1;
+  db->count++;
+  return entry;
+}
+
+
+/** Remembers a change for the next save.
+ *  @param db Pointer to database
+ *  @param name Package added or removed
+ *  @param removed Whether the package was removed
+ *  @return 0 on success, -1 on error
+ */
+static int record_change(PkgDb *db, const char *name, bool removed) {
+  if (db->changes_count >= db->changes_capacity) {
+    int new_capacity = db->changes_capacity == 0 ? 8
+                                                 : db->changes_capacity * 2;
+    PkgDbChange *new_changes = realloc(db->changes,
+                                       (size_t)new_capacity
+                                       * sizeof(PkgDbChange));
+    if (new_changes == NULL) {
+      return -1;
+    }
+    db->changes = new_changes;
+    db->changes_capacity = new_capacity;
+  }
+
+  char *copy = strdup(name);
+  if (copy == NULL) {
+    return -1;
+  }
+  db->changes[db->changes_count].name = copy;
+  db->changes[db->changes_count].removed = removed;
+  db->changes_count++;
   return 0;
 }
 
 
+/** Removes an entry by name without recording the change.
+ *  Its strings stay in the arena until the database is freed.
+ *  @param db Pointer to database
+ *  @param name Package name
+ *  @return 0 on success, -1 if package not found
+ */
+static int drop_entry(PkgDb *db, const char *name) {
+  PkgDbEntry *entry = pkg_db_find(db, name);
+  if (entry == NULL) {
+    return -1;
+  }
+
+  int i = (int)(entry - db->entries);
+  memmove(&db->entries[i], &db->entries[i + 1],
+          (size_t)(db->count - i - 1) * sizeof(PkgDbEntry));
+  db->count--;
+
+  // Later entries moved down, so their slots are rebuilt
+  return rebuild_index(db, db->count);
+}
+
+
+/** Stores an entry read from disk, replacing any entry of the same name.
+ *  @param db Pointer to database
+ *  @param parsed Entry with individually allocated fields, which are
+ *                copied into the arena and freed
+ *  @return 0 on success, -1 on error
+ */
+static int put_entry(PkgDb *db, PkgDbEntry *parsed) {
+  PkgDbEntry *entry = pkg_db_find(db, parsed->name);
+  if (entry == NULL) {
+    entry = append_entry(db, parsed->name);
+  }
+
+  PkgDbEntry copy = {.name = entry != NULL ? entry->name : NULL};
+  int result = -1;
+  if (entry != NULL
+      && arena_strdup(db, parsed->version, &copy.version) == 0
+      && arena_strdup(db, parsed->installed_at, &copy.installed_at) == 0
+      && arena_strdup(db, parsed->description, &copy.description) == 0
+      && arena_strv(db, parsed->files, parsed->files_count,
+                    &copy.files) == 0) {
+    copy.files_count = parsed->files_count;
+    *entry = copy;
+    result = 0;
+  } else if (entry != NULL && entry->version == NULL) {
+    drop_entry(db, entry->name);
+  }
+
+  free_parsed_entry(parsed);
+  return result;
+}
+
+
 /** Adds a package to the database with basic information.
  *  @param db Pointer to database
  *  @param name Package name
@@ -159,7 +394,8 @@ int pkg_db_add(PkgDb *db, const char *name, const char *version) {
 }
 
 
-/** Adds a package to the database with full metadata.
+/** Adds a package to the database with full metadata, or updates the
+ *  version, timestamp and any given metadata of an installed package.
  *  @param db Pointer to database
  *  @param name Package name
  *  @param version Package version
@@ -174,96 +410,39 @@ int pkg_db_add_full(PkgDb *db, const char *name, const char *version,
     return -1;
   }
 
-  PkgDbEntry *existing = pkg_db_find(db, name);
-  if (existing != NULL) {
-    // Update existing entry
-    char *new_version = strdup(version);
-    if (new_version == NULL) {
+  PkgDbEntry *entry = pkg_db_find(db, name);
+  if (entry == NULL) {
+    entry = append_entry(db, name);
+    if (entry == NULL) {
       return -1;
     }
-    free(existing->version);
-    existing->version = new_version;
-
-    // Update timestamp
-    free(existing->installed_at);
-    existing->installed_at = pkg_db_get_timestamp();
-
-    // Update description if provided
-    if (description != NULL) {
-      free(existing->description);
-      existing->description = strdup(description);
-    }
-
-    // Update files if provided
-    if (files != NULL && files_count > 0) {
-      for (int i = 0; i < existing->files_count; i++) {
-        free(existing->files[i]);
-      }
-      free(existing->files);
-
-      existing->files = malloc((size_t)files_count * sizeof(char *));
-      if (existing->files == NULL) {
-        existing->files_count = 0;
-        return -1;
-      }
-      existing->files_count = files_count;
-      for (int i = 0; i < files_count; i++) {
-        existing->files[i] = strdup(files[i]);
-        if (existing->files[i] == NULL) {
-          for (int j = 0; j < i; j++) {
-            free(existing->files[j]);
-          }
-          free(existing->files);
-          existing->files = NULL;
-          existing->files_count = 0;
-          return -1;
-        }
-      }
-    }
-
-    return 0;
-  }
-
-  // Add new entry
-  if (pkg_db_ensure_capacity(db) != 0) {
-    return -1;
   }
 
-  PkgDbEntry *entry = &db->entries[db->count];
-  memset(entry, 0, sizeof(PkgDbEntry));
-
-  entry->name = strdup(name);
-  entry->version = strdup(version);
-  entry->installed_at = pkg_db_get_timestamp();
+  // Fields are only replaced once every copy has been made
+  PkgDbEntry updated = *entry;
+  char *timestamp = pkg_db_get_timestamp();
+  int failed = arena_strdup(db, version, &updated.version) != 0
+               || arena_strdup(db, timestamp, &updated.installed_at) != 0;
+  free(timestamp);
 
-  if (entry->name == NULL || entry->version == NULL) {
-    pkg_db_entry_free(entry);
-    return -1;
+  if (!failed && description != NULL) {
+    failed = arena_strdup(db, description, &updated.description) != 0;
   }
-
-  if (description != NULL) {
-    entry->description = strdup(description);
+  if (!failed && files != NULL && files_count > 0) {
+    failed = arena_strv(db, files, files_count, &updated.files) != 0;
+    updated.files_count = files_count;
   }
 
-  if (files != NULL && files_count > 0) {
-    entry->files = malloc((size_t)files_count * sizeof(char *));
-    if (entry->files == NULL) {
-      pkg_db_entry_free(entry);
-      return -1;
-    }
-    entry->files_count = files_count;
-    for (int i = 0; i < files_count; i++) {
-      entry->files[i] = strdup(files[i]);
-      if (entry->files[i] == NULL) {
-        entry->files_count = i;
-        pkg_db_entry_free(entry);
-        return -1;
-      }
+  if (failed) {
+    // A new entry that could not be filled in is dropped again
+    if (entry->version == NULL) {
+      drop_entry(db, name);
     }
+    return -1;
   }
 
-  db->count++;
-  return 0;
+  *entry = updated;
+  return record_change(db, name, false);
 }
 
 
@@ -277,319 +456,145 @@ int pkg_db_remove(PkgDb *db, const char *name) {
     return -1;
   }
 
-  for (int i = 0; i < db->count; i++) {
-    if (strcmp(db->entries[i].name, name) == 0) {
-      pkg_db_entry_free(&db->entries[i]);
-
-      for (int j = i; j < db->count - 1; j++) {
-        db->entries[j] = db->entries[j + 1];
-      }
-      db->count--;
-
-      return 0;
-    }
+  if (drop_entry(db, name) != 0) {
+    return -1;
   }
-
-  return -1;
+  return record_change(db, name, true);
 }
 
 
 // ---------------------------------------------------------------------------
-// JSON Parsing Helpers
+// JSON Database Loading
 // ---------------------------------------------------------------------------
 
-/** Implementation of skip_whitespace. */
-static const char *skip_whitespace(const char *s) {
-  while (*s && isspace((unsigned char)*s)) {
-    s++;
-  }
-  return s;
-}
-
-
-/** Implementation of parse_string. */
-static char *parse_string(const char **p) {
-  const char *s = *p;
-  s = skip_whitespace(s);
-
-  if (*s != '"') {
-    return NULL;
-  }
-  s++;
-
-  const char *start = s;
-  while (*s && *s != '"') {
-    if (*s == '\\' && *(s + 1)) {
-      s += 2;
-    } else {
-      s++;
+/** Parses the members of one package object or journal record.
+ *  @param r Reader positioned just inside the object
+ *  @param entry Zeroed entry to fill in
+ *  @param op Receives a journal record's "op", or NULL outside the journal
+ *  @return 0 on success, -1 on malformed input
+ */
+static int parse_package_entry(jbox_json_reader_t *r, PkgDbEntry *entry,
+                               char **op) {
+  jbox_json_event_t ev;
+  while ((ev = jbox_json_next(r)) == JBOX_JSON_KEY) {
+    char **field = NULL;
+    if (strcmp(r->text, "name") == 0) {
+      field = &entry->name;
+    } else if (strcmp(r->text, "version") == 0) {
+      field = &entry->version;
+    } else if (strcmp(r->text, "installed_at") == 0) {
+      field = &entry->installed_at;
+    } else if (strcmp(r->text, "description") == 0) {
+      field = &entry->description;
+    } else if (op != NULL && strcmp(r->text, "op") == 0) {
+      field = op;
     }
-  }
-
-  if (*s != '"') {
-    return NULL;
-  }
 
-  size_t len = (size_t)(s - start);
-  char *result = malloc(len + 1);
-  if (result == NULL) {
-    return NULL;
-  }
-
-  size_t j = 0;
-  for (size_t i = 0; i < len; i++) {
-    if (start[i] == '\\' && i + 1 < len) {
-      i++;
-      switch (start[i]) {
-        case 'n': result[j++] = '\n'; break;
-        case 't': result[j++] = '\t'; break;
-        case 'r': result[j++] = '\r'; break;
-        case '"': result[j++] = '"'; break;
-        case '\\': result[j++] = '\\'; break;
-        default: result[j++] = start[i]; break;
+    if (field != NULL) {
+      free(*field);
+      *field = jbox_json_read_string(r);
+    } else if (strcmp(r->text, "files") == 0) {
+      for (int i = 0; i < entry->files_count; i++) {
+        free(entry->files[i]);
       }
-    } else {
-      result[j++] = start[i];
+      free(entry->files);
+      entry->files = jbox_json_read_string_array(r, &entry->files_count);
+    } else if (jbox_json_skip(r, jbox_json_next(r)) != 0) {
+      return -1;
     }
   }
-  result[j] = '\0';
 
-  *p = s + 1;
-  return result;
-}
-
-
-/** Implementation of parse_int. */
-static int parse_int(const char **p) {
-  const char *s = *p;
-  s = skip_whitespace(s);
-
-  int value = 0;
-  int sign = 1;
-
-  if (*s == '-') {
-    sign = -1;
-    s++;
-  }
-
-  while (*s >= '0' && *s <= '9') {
-    value = value * 10 + (*s - '0');
-    s++;
-  }
-
-  *p = s;
-  return value * sign;
+  return ev == JBOX_JSON_OBJECT_END ? 0 : -1;
 }
 
 
-/** Implementation of parse_string_array. */
-static char **parse_string_array(const char **p, int *count) {
-  const char *s = *p;
-  s = skip_whitespace(s);
-
-  if (*s != '[') {
-    *count = 0;
-    return NULL;
+/** Parses the "packages" array into the database.
+ *  Entries without a name are dropped; of two with the same name, the
+ *  later one is kept.
+ *  @param r Reader positioned before the array
+ *  @param db Database receiving the entries
+ *  @return 0 on success, -1 on malformed input or allocation failure
+ */
+static int parse_packages(jbox_json_reader_t *r, PkgDb *db) {
+  jbox_json_event_t ev = jbox_json_next(r);
+  if (ev != JBOX_JSON_ARRAY_BEGIN) {
+    return jbox_json_skip(r, ev);
   }
-  s++;
-
-  char **items = NULL;
-  int capacity = 0;
-  *count = 0;
-
-  while (1) {
-    s = skip_whitespace(s);
-
-    if (*s == ']') {
-      s++;
-      break;
-    }
-
-    if (*count > 0) {
-      if (*s != ',') {
-        goto error;
-      }
-      s++;
-      s = skip_whitespace(s);
-    }
-
-    char *item = parse_string(&s);
-    if (item == NULL) {
-      goto error;
-    }
 
-    if (*count >= capacity) {
-      capacity = capacity == 0 ? 4 : capacity * 2;
-      char **new_items = realloc(items, (size_t)capacity * sizeof(char *));
-      if (new_items == NULL) {
-        free(item);
-        goto error;
+  while ((ev = jbox_json_next(r)) != JBOX_JSON_ARRAY_END) {
+    if (ev != JBOX_JSON_OBJECT_BEGIN) {
+      if (jbox_json_skip(r, ev) != 0) {
+        return -1;
       }
-      items = new_items;
+      continue;
     }
 
-    items[*count] = item;
-    (*count)++;
-  }
-
-  *p = s;
-  return items;
-
-error:
-  for (int i = 0; i < *count; i++) {
-    free(items[i]);
-  }
-  free(items);
-  *count = 0;
-  return NULL;
-}
-
-
-/** Implementation of skip_value. */
-static const char *skip_value(const char *s) {
-  s = skip_whitespace(s);
-
-  if (*s == '"') {
-    s++;
-    while (*s && *s != '"') {
-      if (*s == '\\' && *(s + 1)) {
-        s += 2;
-      } else {
-        s++;
-      }
+    PkgDbEntry entry = {0};
+    if (parse_package_entry(r, &entry, NULL) != 0) {
+      free_parsed_entry(&entry);
+      return -1;
     }
-    if (*s == '"') s++;
-    return s;
-  }
-
-  if (*s == '[') {
-    s++;
-    int depth = 1;
-    while (*s && depth > 0) {
-      if (*s == '[') depth++;
-      else if (*s == ']') depth--;
-      else if (*s == '"') {
-        s++;
-        while (*s && *s != '"') {
-          if (*s == '\\' && *(s + 1)) s += 2;
-          else s++;
-        }
-        if (*s == '"') s++;
-        continue;
-      }
-      s++;
+    if (entry.name == NULL) {
+      free_parsed_entry(&entry);
+      continue;
     }
-    return s;
-  }
-
-  if (*s == '{') {
-    s++;
-    int depth = 1;
-    while (*s && depth > 0) {
-      if (*s == '{') depth++;
-      else if (*s == '}') depth--;
-      else if (*s == '"') {
-        s++;
-        while (*s && *s != '"') {
-          if (*s == '\\' && *(s + 1)) s += 2;
-          else s++;
-        }
-        if (*s == '"') s++;
-        continue;
-      }
-      s++;
+    if (put_entry(db, &entry) != 0) {
+      return -1;
     }
-    return s;
   }
 
-  while (*s && *s != ',' && *s != '}' && *s != ']') {
-    s++;
-  }
-  return s;
+  return 0;
 }
 
 
-// ---------------------------------------------------------------------------
-// JSON Database Loading
-// ---------------------------------------------------------------------------
-
-/** Parses a single package entry from JSON.
- *  @param p Pointer to string pointer (updated after parse)
- *  @return Allocated PkgDbEntry, or NULL on error. Caller must free.
+/** Replays the journal over the database.
+ *  Only complete lines are records; a line cut short by a crash, or one
+ *  that does not parse, is skipped.
+ *  @param db Database loaded from the snapshot
  */
-static PkgDbEntry *parse_package_entry(const char **p) {
-  const char *s = *p;
-  s = skip_whitespace(s);
-
-  if (*s != '{') {
-    return NULL;
+static void replay_journal(PkgDb *db) {
+  char *journal_path = pkg_get_journal_path();
+  if (journal_path == NULL) {
+    return;
   }
-  s++;
-
-  PkgDbEntry *entry = calloc(1, sizeof(PkgDbEntry));
-  if (entry == NULL) {
-    return NULL;
+  char *content = pkg_read_file(journal_path);
+  free(journal_path);
+  if (content == NULL) {
+    return;
   }
 
-  int first = 1;
-  while (1) {
-    s = skip_whitespace(s);
-
-    if (*s == '}') {
-      s++;
-      break;
-    }
-
-    if (!first) {
-      if (*s != ',') {
-        goto error;
+  char *line = content;
+  char *end;
+  while ((end = strchr(line, '\n')) != NULL) {
+    jbox_json_reader_t r;
+    jbox_json_reader_init(&r, line, (size_t)(end - line));
+
+    PkgDbEntry entry = {0};
+    char *op = NULL;
+    if (jbox_json_next(&r) == JBOX_JSON_OBJECT_BEGIN
+        && parse_package_entry(&r, &entry, &op) == 0
+        && op != NULL && entry.name != NULL) {
+      if (strcmp(op, "remove") == 0) {
+        drop_entry(db, entry.name);
+        db->journal_records++;
+      } else if (strcmp(op, "add") == 0 && entry.version != NULL) {
+        put_entry(db, &entry);
+        db->journal_records++;
       }
-      s++;
-      s = skip_whitespace(s);
     }
-    first = 0;
 
-    char *key = parse_string(&s);
-    if (key == NULL) {
-      goto error;
-    }
-
-    s = skip_whitespace(s);
-    if (*s != ':') {
-      free(key);
-      goto error;
-    }
-    s++;
-    s = skip_whitespace(s);
-
-    if (strcmp(key, "name") == 0) {
-      entry->name = parse_string(&s);
-    } else if (strcmp(key, "version") == 0) {
-      entry->version = parse_string(&s);
-    } else if (strcmp(key, "installed_at") == 0) {
-      entry->installed_at = parse_string(&s);
-    } else if (strcmp(key, "description") == 0) {
-      entry->description = parse_string(&s);
-    } else if (strcmp(key, "files") == 0) {
-      entry->files = parse_string_array(&s, &entry->files_count);
-    } else {
-      s = skip_value(s);
-    }
-
-    free(key);
+    free_parsed_entry(&entry);
+    free(op);
+    jbox_json_reader_free(&r);
+    line = end + 1;
   }
 
-  *p = s;
-  return entry;
-
-error:
-  pkg_db_entry_free(entry);
-  free(entry);
-  return NULL;
+  free(content);
 }
 
 
-/** Loads the package database from JSON file.
+/** Loads the package database from JSON file and its journal.
+ *  A damaged file yields the packages read before the damage.
  *  @return Allocated database, or NULL on error. Caller must free.
  */
 PkgDb *pkg_db_load_json(void) {
@@ -609,135 +614,207 @@ PkgDb *pkg_db_load_json(void) {
   free(db_path);
 
   if (content == NULL) {
-    // File doesn't exist, return empty db
+    // No snapshot yet, only journaled changes if any
+    replay_journal(db);
     return db;
   }
 
-  const char *s = content;
-  s = skip_whitespace(s);
+  jbox_json_reader_t r;
+  jbox_json_reader_init(&r, content, strlen(content));
 
-  if (*s != '{') {
-    free(content);
-    return db;
+  if (jbox_json_next(&r) == JBOX_JSON_OBJECT_BEGIN) {
+    while (jbox_json_next(&r) == JBOX_JSON_KEY) {
+      if (strcmp(r.text, "version") == 0) {
+        long long version;
+        if (jbox_json_read_int(&r, &version)) {
+          db->db_version = (int)version;
+        }
+      } else if (strcmp(r.text, "packages") == 0) {
+        if (parse_packages(&r, db) != 0) {
+          break;
+        }
+      } else if (jbox_json_skip(&r, jbox_json_next(&r)) != 0) {
+        break;
+      }
+    }
   }
-  s++;
 
-  int first = 1;
-  while (1) {
-    s = skip_whitespace(s);
+  jbox_json_reader_free(&r);
+  free(content);
+  replay_journal(db);
+  return db;
+}
 
-    if (*s == '}') {
-      break;
-    }
 
-    if (!first) {
-      if (*s != ',') {
-        break;
-      }
-      s++;
-      s = skip_whitespace(s);
-    }
-    first = 0;
+// ---------------------------------------------------------------------------
+// JSON Database Saving
+// ---------------------------------------------------------------------------
 
-    char *key = parse_string(&s);
-    if (key == NULL) {
-      break;
-    }
+/** Writes the members of a package object.
+ *  @param w Writer inside the object
+ *  @param entry Package to write
+ */
+static void write_entry_fields(jbox_json_writer_t *w, const PkgDbEntry *entry) {
+  jbox_json_key(w, "name");
+  jbox_json_string(w, entry->name);
+  jbox_json_key(w, "version");
+  jbox_json_string(w, entry->version);
+
+  if (entry->installed_at != NULL) {
+    jbox_json_key(w, "installed_at");
+    jbox_json_string(w, entry->installed_at);
+  }
 
-    s = skip_whitespace(s);
-    if (*s != ':') {
-      free(key);
-      break;
+  if (entry->description != NULL) {
+    jbox_json_key(w, "description");
+    jbox_json_string(w, entry->description);
+  }
+
+  if (entry->files != NULL && entry->files_count > 0) {
+    jbox_json_key(w, "files");
+    jbox_json_begin_array(w);
+    for (int j = 0; j < entry->files_count; j++) {
+      jbox_json_string(w, entry->files[j]);
     }
-    s++;
-    s = skip_whitespace(s);
-
-    if (strcmp(key, "version") == 0) {
-      db->db_version = parse_int(&s);
-    } else if (strcmp(key, "packages") == 0) {
-      // Parse packages array
-      if (*s != '[') {
-        free(key);
-        break;
-      }
-      s++;
+    jbox_json_end_array(w);
+  }
+}
 
-      int first_pkg = 1;
-      while (1) {
-        s = skip_whitespace(s);
 
-        if (*s == ']') {
-          s++;
-          break;
-        }
+/** Writes a buffer to a descriptor, retrying short writes.
+ *  @param fd Descriptor to write to
+ *  @param buf Data
+ *  @param len Length of data
+ *  @return 0 on success, -1 on error
+ */
+static int write_all(int fd, const void *buf, size_t len) {
+  const char *p = buf;
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
 
-        if (!first_pkg) {
-          if (*s != ',') {
-            break;
-          }
-          s++;
-          s = skip_whitespace(s);
-        }
-        first_pkg = 0;
 
-        PkgDbEntry *entry = parse_package_entry(&s);
-        if (entry == NULL) {
-          break;
-        }
+/** Flushes the directory holding the database, so a rename in it lasts.
+ *  @return 0 on success, -1 on error
+ */
+static int sync_pkgs_dir(void) {
+  char *pkgs_dir = pkg_get_pkgs_dir();
+  if (pkgs_dir == NULL) {
+    return -1;
+  }
+  int fd = open(pkgs_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  free(pkgs_dir);
+  if (fd < 0) {
+    return -1;
+  }
+  int result = fsync(fd);
+  close(fd);
+  return result;
+}
 
-        if (pkg_db_ensure_capacity(db) != 0) {
-          pkg_db_entry_free(entry);
-          free(entry);
-          break;
-        }
 
-        db->entries[db->count] = *entry;
-        free(entry);  // Just free the container, not the contents
-        db->count++;
+/** Appends the pending changes to the journal with a single write.
+ *  An added package is written with its current metadata; one removed
+ *  again later is left to the removal record.
+ *  @param db Pointer to database
+ *  @return 0 on success, -1 on error
+ */
+static int append_journal(PkgDb *db) {
+  char *buf = NULL;
+  size_t len = 0;
+  FILE *mem = open_memstream(&buf, &len);
+  if (mem == NULL) {
+    return -1;
+  }
+
+  int records = 0;
+  for (int i = 0; i < db->changes_count; i++) {
+    const PkgDbChange *change = &db->changes[i];
+    const PkgDbEntry *entry = NULL;
+    if (!change->removed) {
+      entry = pkg_db_find(db, change->name);
+      if (entry == NULL) {
+        continue;
       }
+    }
+
+    jbox_json_writer_t w;
+    jbox_json_writer_init(&w, mem, false);
+    jbox_json_begin_object(&w);
+    jbox_json_key(&w, "op");
+    jbox_json_string(&w, change->removed ? "remove" : "add");
+    if (change->removed) {
+      jbox_json_key(&w, "name");
+      jbox_json_string(&w, change->name);
     } else {
-      s = skip_value(s);
+      write_entry_fields(&w, entry);
     }
+    jbox_json_end_object(&w);
+    fputc('\n', mem);
+    records++;
+  }
 
-    free(key);
+  if (fclose(mem) != 0) {
+    free(buf);
+    return -1;
   }
 
-  free(content);
-  return db;
-}
+  char *journal_path = pkg_get_journal_path();
+  if (journal_path == NULL) {
+    free(buf);
+    return -1;
+  }
+  int fd = open(journal_path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC,
+                0644);
+  free(journal_path);
+  if (fd < 0) {
+    free(buf);
+    return -1;
+  }
 
+  // Close off a record cut short by a crash so it stays a line of its own
+  struct stat st;
+  char last = '\n';
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    if (pread(fd, &last, 1, st.st_size - 1) != 1) {
+      last = '\n';
+    }
+  }
 
-// ---------------------------------------------------------------------------
-// JSON Database Saving
-// ---------------------------------------------------------------------------
+  int result = 0;
+  if ((last != '\n' && write_all(fd, "\n", 1) != 0)
+      || write_all(fd, buf, len) != 0 || fdatasync(fd) != 0) {
+    result = -1;
+  }
+  if (close(fd) != 0) {
+    result = -1;
+  }
+  free(buf);
 
-/** Writes a JSON-escaped string to file.
- *  @param f Output file stream
- *  @param str String to write (can be NULL)
- */
-static void write_escaped_string(FILE *f, const char *str) {
-  fputc('"', f);
-  if (str != NULL) {
-    for (const char *p = str; *p; p++) {
-      switch (*p) {
-        case '"': fputs("\\\"", f); break;
-        case '\\': fputs("\\\\", f); break;
-        case '\n': fputs("\\n", f); break;
-        case '\t': fputs("\\t", f); break;
-        case '\r': fputs("\\r", f); break;
-        default: fputc(*p, f); break;
-      }
-    }
+  if (result == 0) {
+    db->journal_records += records;
   }
-  fputc('"', f);
+  return result;
 }
 
 
-/** Saves the package database to JSON file.
+/** Saves the whole package database as a new snapshot.
+ *  The snapshot is written to a temporary file, flushed and renamed over
+ *  pkgdb.json, and only then is the journal removed.
  *  @param db Pointer to database
  *  @return 0 on success, -1 on error
  */
-int pkg_db_save_json(const PkgDb *db) {
+int pkg_db_save_json(PkgDb *db) {
   if (pkg_ensure_dirs() != 0) {
     return -1;
   }
@@ -747,61 +824,61 @@ int pkg_db_save_json(const PkgDb *db) {
     return -1;
   }
 
-  FILE *f = fopen(db_path, "w");
-  free(db_path);
+  size_t tmp_len = strlen(db_path) + strlen(".tmp") + 1;
+  char *tmp_path = malloc(tmp_len);
+  if (tmp_path == NULL) {
+    free(db_path);
+    return -1;
+  }
+  snprintf(tmp_path, tmp_len, "%s.tmp", db_path);
 
+  FILE *f = fopen(tmp_path, "w");
   if (f == NULL) {
+    free(tmp_path);
+    free(db_path);
     return -1;
   }
 
-  fprintf(f, "{\n");
-  fprintf(f, "  \"version\": %d,\n", PKG_DB_VERSION);
-  fprintf(f, "  \"packages\": [");
+  jbox_json_writer_t w;
+  jbox_json_writer_init(&w, f, true);
+  jbox_json_begin_object(&w);
+  jbox_json_key(&w, "version");
+  jbox_json_int(&w, PKG_DB_VERSION);
+  jbox_json_key(&w, "packages");
+  jbox_json_begin_array(&w);
 
   for (int i = 0; i < db->count; i++) {
-    if (i > 0) {
-      fprintf(f, ",");
-    }
-    fprintf(f, "\n    {\n");
-
-    fprintf(f, "      \"name\": ");
-    write_escaped_string(f, db->entries[i].name);
-    fprintf(f, ",\n");
-
-    fprintf(f, "      \"version\": ");
-    write_escaped_string(f, db->entries[i].version);
-
-    if (db->entries[i].installed_at != NULL) {
-      fprintf(f, ",\n      \"installed_at\": ");
-      write_escaped_string(f, db->entries[i].installed_at);
-    }
+    jbox_json_begin_object(&w);
+    write_entry_fields(&w, &db->entries[i]);
+    jbox_json_end_object(&w);
+  }
 
-    if (db->entries[i].description != NULL) {
-      fprintf(f, ",\n      \"description\": ");
-      write_escaped_string(f, db->entries[i].description);
-    }
+  jbox_json_end_array(&w);
+  jbox_json_end_object(&w);
+  fputc('\n', f);
 
-    if (db->entries[i].files != NULL && db->entries[i].files_count > 0) {
-      fprintf(f, ",\n      \"files\": [");
-      for (int j = 0; j < db->entries[i].files_count; j++) {
-        if (j > 0) {
-          fprintf(f, ", ");
-        }
-        write_escaped_string(f, db->entries[i].files[j]);
-      }
-      fprintf(f, "]");
-    }
-
-    fprintf(f, "\n    }");
+  int failed = fflush(f) != 0 || fsync(fileno(f)) != 0;
+  if (fclose(f) != 0 || failed || rename(tmp_path, db_path) != 0) {
+    unlink(tmp_path);
+    free(tmp_path);
+    free(db_path);
+    return -1;
   }
+  free(tmp_path);
+  free(db_path);
+  sync_pkgs_dir();
 
-  if (db->count > 0) {
-    fprintf(f, "\n  ");
+  // Everything in the journal is in the snapshot now
+  char *journal_path = pkg_get_journal_path();
+  if (journal_path != NULL) {
+    unlink(journal_path);
+    free(journal_path);
   }
-  fprintf(f, "]\n}\n");
+  db->journal_records = 0;
+  clear_changes(db);
 
-  fclose(f);
-  return 0;
+  // Keep the shell's command index in step with the database
+  return pkg_index_write(db);
 }
 
 
@@ -939,6 +1016,14 @@ PkgDb *pkg_db_load(void) {
   int json_exists = (stat(json_path, &st) == 0);
   free(json_path);
 
+  // Changes may have been journaled before any snapshot was written
+  char *journal_path = pkg_get_journal_path();
+  if (journal_path == NULL) {
+    return NULL;
+  }
+  json_exists = json_exists || stat(journal_path, &st) == 0;
+  free(journal_path);
+
   if (json_exists) {
     return pkg_db_load_json();
   }
@@ -970,10 +1055,40 @@ PkgDb *pkg_db_load(void) {
 }
 
 
-/** Saves the package database to disk.
+/** Saves the changes made to the package database.
+ *  They are appended to the journal, unless there is no snapshot yet or
+ *  the journal has grown as large as the database, in which case a new
+ *  snapshot is written instead.
  *  @param db Pointer to database
  *  @return 0 on success, -1 on error
  */
-int pkg_db_save(const PkgDb *db) {
-  return pkg_db_save_json(db);
+int pkg_db_save(PkgDb *db) {
+  if (db == NULL) {
+    return -1;
+  }
+
+  char *db_path = pkg_get_db_path();
+  if (db_path == NULL) {
+    return -1;
+  }
+  struct stat st;
+  int snapshot_exists = stat(db_path, &st) == 0;
+  free(db_path);
+
+  int records = db->journal_records + db->changes_count;
+  if (!snapshot_exists
+      || (records >= PKG_DB_COMPACT_MIN && records >= db->count)) {
+    return pkg_db_save_json(db);
+  }
+  if (db->changes_count == 0) {
+    return 0;
+  }
+
+  if (append_journal(db) != 0) {
+    return -1;
+  }
+  clear_changes(db);
+
+  // Keep the shell's command index in step with the database
+  return pkg_index_write(db);
 }
@@ -1,8 +1,27 @@
 #ifndef PKG_DB_H
 #define PKG_DB_H
 
+#include <stdbool.h>
+
+// Package database (~/.jshell/pkgs/pkgdb.json and pkgdb.journal)
+//
+// pkgdb.json is a snapshot of the database. Saving appends the changes
+// made since the last save to pkgdb.journal, one JSON record per line,
+// and loading replays the journal over the snapshot. Once the journal
+// holds as many records as the database has packages, it is compacted:
+// a new snapshot is written to a temporary file and renamed into place,
+// and the journal is removed. A record cut short by a crash is ignored.
+
 #define PKG_DB_VERSION 1
 
+// Journal records below which the journal is never compacted
+#define PKG_DB_COMPACT_MIN 64
+
+// Size of a regular string arena chunk (larger requests get their own)
+#define PKG_DB_ARENA_CHUNK_SIZE 4096
+
+// An installed package; its strings and files array live in the arena of
+// the database holding it
 typedef struct {
   char *name;
   char *version;
@@ -12,11 +31,26 @@ typedef struct {
   int files_count;
 } PkgDbEntry;
 
+typedef struct PkgDbArenaChunk PkgDbArenaChunk;
+
+// A package added or removed since the database was last saved
+typedef struct {
+  char *name;
+  bool removed;
+} PkgDbChange;
+
 typedef struct {
   int db_version;
   PkgDbEntry *entries;
   int count;
   int capacity;
+  int *slots;              // Hash index by name: entry index + 1, 0 if free
+  int slot_count;          // Power of two, at least twice count
+  PkgDbArenaChunk *arena;  // Bump allocator owning the entries' strings
+  PkgDbChange *changes;    // Changes not yet in the journal, in order
+  int changes_count;
+  int changes_capacity;
+  int journal_records;     // Records in the journal on disk
 } PkgDb;
 
 // Load package database (prefers JSON, falls back to txt with migration)
@@ -24,17 +58,17 @@ typedef struct {
 // Returns NULL on error
 PkgDb *pkg_db_load(void);
 
-// Save package database to JSON format
+// Save the changes made to the database since it was loaded or last
+// saved, compacting the journal when it has grown large; a caller making
+// several changes saves once at the end
 // Returns 0 on success, -1 on error
-int pkg_db_save(const PkgDb *db);
+int pkg_db_save(PkgDb *db);
 
 // Free all memory associated with database
 void pkg_db_free(PkgDb *db);
 
-// Free all memory associated with a single entry (does not free entry itself)
-void pkg_db_entry_free(PkgDbEntry *entry);
-
-// Find entry by name (returns pointer to entry in db, or NULL)
+// Find entry by name through the hash index (returns pointer to entry in
+// db, valid until the next add or remove, or NULL)
 PkgDbEntry *pkg_db_find(const PkgDb *db, const char *name);
 
 // Add entry to database (copies all strings)
@@ -55,9 +89,10 @@ int pkg_db_remove(PkgDb *db, const char *name);
 // Returns NULL on error
 PkgDb *pkg_db_load_json(void);
 
-// Save package database to JSON file
+// Write the whole database as a new pkgdb.json snapshot, atomically, and
+// drop the journal
 // Returns 0 on success, -1 on error
-int pkg_db_save_json(const PkgDb *db);
+int pkg_db_save_json(PkgDb *db);
 
 // Migrate from txt format to JSON format
 // Returns 0 on success, -1 on error
@@ -0,0 +1,670 @@
+/** @file pkg_delta.c
+ *  @brief Binary deltas between published versions of a package.
+ *
+ *  A delta is an 8-byte magic followed by one record per entry of the
+ *  new package, in path order, and an end record. Integers are little
+ *  endian, strings a 16-bit length and their bytes, and digests 64 hex
+ *  digits:
+ *
+ *    'D' path mode                          directory
+ *    'L' path target                        symlink
+ *    'C' path mode base sha                 copy of base, whose digest is sha
+ *    'P' path mode base sha new size zlen   base patched: the zstd frame
+ *        frame                              that follows decompresses to
+ *                                           the file with base as prefix
+ *    'F' path mode new size zlen frame      file carried whole
+ *    'E'                                    end
+ *
+ *  Patches are made at a high level with a window spanning base and
+ *  file, so zstd finds matches anywhere in the old version; a patch
+ *  larger than the file compressed on its own is replaced by the latter.
+ *  Files are created below the destination through descriptors opened
+ *  with O_NOFOLLOW, as tarball extraction does, so a symlink in the delta
+ *  can never redirect a later entry out of it.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <zstd.h>
+
+#include "pkg_delta.h"
+#include "pkg_files.h"
+#include "pkg_json.h"
+#include "utils/jbox_hash.h"
+#include "utils/jbox_walk.h"
+
+
+#define DELTA_MAGIC "JPKGDLT1"
+#define DELTA_MAGIC_LEN 8
+
+/** zstd level of patches and whole files; deltas are made once, at
+ *  publishing time, and downloaded many times. */
+#define DELTA_LEVEL 19
+
+/** Largest window a patch may need, zstd's default decoder limit: base
+ *  and file together must fit in it to be patched. */
+#define DELTA_MAX_WINDOW_LOG 27
+
+/** Largest file a delta may carry. */
+#define DELTA_MAX_FILE ((uint64_t)1 << 30)
+
+
+// ---------------------------------------------------------------------------
+// Files and digests
+// ---------------------------------------------------------------------------
+
+/** Reads a whole regular file below a directory.
+ *  @param dir_fd Directory
+ *  @param path Path below it
+ *  @param len Set to the file's size
+ *  @return Allocated contents, or NULL on error (errno set)
+ */
+static unsigned char *read_file(int dir_fd, const char *path, size_t *len) {
+  int fd = openat(dir_fd, path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd < 0) return NULL;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+      (uint64_t)st.st_size > DELTA_MAX_FILE) {
+    if (errno == 0) errno = EINVAL;
+    close(fd);
+    return NULL;
+  }
+
+  size_t size = (size_t)st.st_size;
+  unsigned char *data = malloc(size > 0 ? size : 1);
+  size_t got = 0;
+  while (data != NULL && got < size) {
+    ssize_t n = read(fd, data + got, size - got);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      if (n == 0) errno = EIO;
+      free(data);
+      data = NULL;
+      break;
+    }
+    got += (size_t)n;
+  }
+  close(fd);
+  *len = size;
+  return data;
+}
+
+
+/** Hashes a buffer.
+ *  @param data Bytes
+ *  @param len Number of bytes
+ *  @param hex Set to the hex SHA-256
+ */
+static void digest(const void *data, size_t len,
+                   char hex[PKG_SHA256_HEX_LEN + 1]) {
+  jbox_sha256_t md;
+  jbox_sha256_init(&md);
+  jbox_sha256_update(&md, data, len);
+  uint8_t raw[JBOX_SHA256_LEN];
+  jbox_sha256_final(&md, raw);
+  jbox_hash_hex(raw, sizeof(raw), hex);
+}
+
+
+/** Picks the window log that lets a patch reach back over all of base.
+ *  @param total Size of base and file together
+ *  @return Window log
+ */
+static int window_log(size_t total) {
+  int log = 10;  // zstd's smallest window
+  while (((size_t)1 << log) < total && log < DELTA_MAX_WINDOW_LOG) log++;
+  return log;
+}
+
+
+// ---------------------------------------------------------------------------
+// Creating deltas
+// ---------------------------------------------------------------------------
+
+static void put_u16(FILE *f, uint64_t v) {
+  for (int i = 0; i < 2; i++) fputc((int)(v >> (8 * i)) & 0xff, f);
+}
+
+static void put_u32(FILE *f, uint64_t v) {
+  for (int i = 0; i < 4; i++) fputc((int)(v >> (8 * i)) & 0xff, f);
+}
+
+static void put_u64(FILE *f, uint64_t v) {
+  for (int i = 0; i < 8; i++) fputc((int)(v >> (8 * i)) & 0xff, f);
+}
+
+/** Writes a length-prefixed string.
+ *  @return 0 on success, -1 if it is too long
+ */
+static int put_str(FILE *f, const char *s) {
+  size_t n = strlen(s);
+  if (n > 0xffff) return -1;
+  put_u16(f, n);
+  fwrite(s, 1, n, f);
+  return 0;
+}
+
+
+/** Compresses a file, optionally against a prefix.
+ *  @param cctx Compression context
+ *  @param data File contents
+ *  @param len Size of the file
+ *  @param prefix Old contents to refer to, or NULL
+ *  @param prefix_len Size of prefix
+ *  @param out_len Set to the size of the frame
+ *  @return Allocated zstd frame, or NULL on error
+ */
+static unsigned char *compress_file(ZSTD_CCtx *cctx, const void *data,
+                                    size_t len, const void *prefix,
+                                    size_t prefix_len, size_t *out_len) {
+  ZSTD_CCtx_reset(cctx, ZSTD_reset_session_and_parameters);
+  ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, DELTA_LEVEL);
+  if (prefix != NULL) {
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_windowLog,
+                           window_log(prefix_len + len));
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_enableLongDistanceMatching, 1);
+    if (ZSTD_isError(ZSTD_CCtx_refPrefix(cctx, prefix, prefix_len))) {
+      return NULL;
+    }
+  }
+
+  size_t bound = ZSTD_compressBound(len);
+  unsigned char *out = malloc(bound);
+  if (out == NULL) return NULL;
+  size_t n = ZSTD_compress2(cctx, out, bound, data, len);
+  if (ZSTD_isError(n)) {
+    free(out);
+    return NULL;
+  }
+  *out_len = n;
+  return out;
+}
+
+
+static int compare_entries(const void *a, const void *b) {
+  return jbox_walk_compare_paths(((const PkgFileEntry *)a)->path,
+                                 ((const PkgFileEntry *)b)->path);
+}
+
+
+/** Finds the old file a new one is best made from.
+ *  @param old Old package's entries, sorted by path
+ *  @param usable Which of them may be used as bases
+ *  @param e New file
+ *  @param same Set to 1 if the base has the same contents
+ *  @return Base entry, or NULL if there is none
+ */
+static const PkgFileEntry *find_base(const PkgFileList *old,
+                                     const char *usable,
+                                     const PkgFileEntry *e, int *same) {
+  PkgFileEntry *at = bsearch(e, old->items, old->count, sizeof(PkgFileEntry),
+                             compare_entries);
+  if (at != NULL && !usable[at - old->items]) at = NULL;
+
+  *same = 1;
+  if (at != NULL && strcmp(at->sha256, e->sha256) == 0) return at;
+  for (size_t i = 0; i < old->count; i++) {
+    if (usable[i] && strcmp(old->items[i].sha256, e->sha256) == 0) {
+      return &old->items[i];
+    }
+  }
+  *same = 0;
+  return at;
+}
+
+
+/** Writes the record of one regular file of the new version.
+ *  @param out Delta being written
+ *  @param cctx Compression context
+ *  @param old_fd Old package directory
+ *  @param new_fd New package directory
+ *  @param e New file
+ *  @param base File of the old version it is made from, or NULL
+ *  @return 0 on success, -1 on error (errno set)
+ */
+static int put_file(FILE *out, ZSTD_CCtx *cctx, int old_fd, int new_fd,
+                    const PkgFileEntry *e, const PkgFileEntry *base) {
+  size_t len;
+  unsigned char *data = read_file(new_fd, e->path, &len);
+  if (data == NULL) return -1;
+
+  size_t full_len = 0;
+  unsigned char *full = compress_file(cctx, data, len, NULL, 0, &full_len);
+
+  size_t patch_len = 0;
+  unsigned char *patch = NULL;
+  if (base != NULL &&
+      base->size + len <= ((uint64_t)1 << DELTA_MAX_WINDOW_LOG)) {
+    size_t old_len;
+    unsigned char *old = read_file(old_fd, base->path, &old_len);
+    if (old != NULL) {
+      patch = compress_file(cctx, data, len, old, old_len, &patch_len);
+      free(old);
+    }
+  }
+  free(data);
+  if (full == NULL) {
+    free(patch);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  if (patch != NULL && patch_len < full_len) {
+    fputc('P', out);
+    put_str(out, e->path);
+    put_u32(out, e->mode);
+    put_str(out, base->path);
+    fputs(base->sha256, out);
+    fputs(e->sha256, out);
+    put_u64(out, len);
+    put_u64(out, patch_len);
+    fwrite(patch, 1, patch_len, out);
+  } else {
+    fputc('F', out);
+    put_str(out, e->path);
+    put_u32(out, e->mode);
+    fputs(e->sha256, out);
+    put_u64(out, len);
+    put_u64(out, full_len);
+    fwrite(full, 1, full_len, out);
+  }
+  free(patch);
+  free(full);
+  return 0;
+}
+
+
+/** Writes the delta between two package directories.
+ *  @param fd File to write it to
+ *  @param old_dir Published old version
+ *  @param new_dir Published new version
+ *  @return 0 on success, -1 on error
+ */
+int pkg_delta_create(int fd, const char *old_dir, const char *new_dir) {
+  PkgFileList old = {0};
+  PkgFileList new = {0};
+  if (pkg_files_scan(old_dir, NULL, &old) != 0) return -1;
+  if (pkg_files_scan(new_dir, NULL, &new) != 0) {
+    pkg_files_free(&old);
+    return -1;
+  }
+
+  // Files an install rewrites do not stay as published
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/Makefile", old_dir);
+  struct stat st;
+  PkgManifest *m = NULL;
+  if (stat(path, &st) == 0) {
+    snprintf(path, sizeof(path), "%s/pkg.json", old_dir);
+    m = pkg_manifest_load(path);
+  }
+  char *usable = calloc(old.count > 0 ? old.count : 1, 1);
+  for (size_t i = 0; usable != NULL && i < old.count; i++) {
+    usable[i] = old.items[i].type == DT_REG &&
+                (m == NULL || !pkg_files_private(m, old.items[i].path));
+  }
+  pkg_manifest_free(m);
+
+  int old_fd = open(old_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  int new_fd = open(new_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  ZSTD_CCtx *cctx = ZSTD_createCCtx();
+  int out_fd = dup(fd);
+  FILE *out = out_fd >= 0 ? fdopen(out_fd, "wb") : NULL;
+  if (out == NULL && out_fd >= 0) close(out_fd);
+
+  int rc = 0;
+  const char *failed_path = NULL;
+  if (usable == NULL || old_fd < 0 || new_fd < 0 || cctx == NULL ||
+      out == NULL) {
+    rc = -1;
+  } else {
+    fwrite(DELTA_MAGIC, 1, DELTA_MAGIC_LEN, out);
+  }
+
+  for (size_t i = 0; rc == 0 && i < new.count; i++) {
+    const PkgFileEntry *e = &new.items[i];
+    int same = 0;
+    const PkgFileEntry *base = e->type == DT_REG
+                               ? find_base(&old, usable, e, &same) : NULL;
+    if (e->type == DT_DIR) {
+      fputc('D', out);
+      rc = put_str(out, e->path);
+      put_u32(out, e->mode);
+    } else if (e->type == DT_LNK) {
+      fputc('L', out);
+      rc = put_str(out, e->path) | put_str(out, e->link);
+    } else if (same) {
+      fputc('C', out);
+      rc = put_str(out, e->path);
+      put_u32(out, e->mode);
+      rc |= put_str(out, base->path);
+      fputs(base->sha256, out);
+    } else {
+      rc = put_file(out, cctx, old_fd, new_fd, e, base);
+    }
+    if (rc != 0) failed_path = e->path;
+  }
+
+  if (rc == 0) {
+    fputc('E', out);
+  }
+  if (out != NULL) {
+    int failed = ferror(out);
+    if ((fclose(out) != 0 || failed) && rc == 0) rc = -1;
+  }
+  if (rc != 0) {
+    if (failed_path != NULL) {
+      fprintf(stderr, "pkg delta: cannot add %s: %s\n", failed_path,
+              strerror(errno ? errno : ENAMETOOLONG));
+    } else {
+      fprintf(stderr, "pkg delta: cannot write delta: %s\n",
+              strerror(errno ? errno : ENOMEM));
+    }
+  }
+
+  ZSTD_freeCCtx(cctx);
+  if (old_fd >= 0) close(old_fd);
+  if (new_fd >= 0) close(new_fd);
+  free(usable);
+  pkg_files_free(&old);
+  pkg_files_free(&new);
+  return rc;
+}
+
+
+// ---------------------------------------------------------------------------
+// Applying deltas
+// ---------------------------------------------------------------------------
+
+/** Position in a delta being read. */
+typedef struct {
+  const unsigned char *p;
+  const unsigned char *end;
+  int bad;                // Read past the end
+} cursor_t;
+
+
+static uint64_t get_uint(cursor_t *c, int bytes) {
+  if (c->end - c->p < bytes) {
+    c->bad = 1;
+    return 0;
+  }
+  uint64_t v = 0;
+  for (int i = 0; i < bytes; i++) v |= (uint64_t)c->p[i] << (8 * i);
+  c->p += bytes;
+  return v;
+}
+
+
+/** Takes the next len bytes.
+ *  @return Pointer into the delta, or NULL if it is too short
+ */
+static const unsigned char *get_bytes(cursor_t *c, uint64_t len) {
+  if ((uint64_t)(c->end - c->p) < len) {
+    c->bad = 1;
+    return NULL;
+  }
+  const unsigned char *p = c->p;
+  c->p += len;
+  return p;
+}
+
+
+/** Reads a length-prefixed string.
+ *  @return Allocated string, or NULL if malformed or it holds a NUL
+ */
+static char *get_str(cursor_t *c) {
+  uint64_t n = get_uint(c, 2);
+  const unsigned char *s = get_bytes(c, n);
+  if (s == NULL || memchr(s, '\0', n) != NULL) return NULL;
+  return strndup((const char *)s, n);
+}
+
+
+/** Reads a hex digest.
+ *  @param hex Set to the digest
+ *  @return 0 on success, -1 if malformed
+ */
+static int get_digest(cursor_t *c, char hex[PKG_SHA256_HEX_LEN + 1]) {
+  const unsigned char *s = get_bytes(c, PKG_SHA256_HEX_LEN);
+  if (s == NULL) return -1;
+  memcpy(hex, s, PKG_SHA256_HEX_LEN);
+  hex[PKG_SHA256_HEX_LEN] = '\0';
+  return 0;
+}
+
+
+/** Opens the directory that holds an entry, creating missing ones.
+ *  Each component is opened with O_NOFOLLOW.
+ *  @param dest_fd Destination directory
+ *  @param path Checked path of the entry
+ *  @param leaf Set to the entry's last component within path
+ *  @return Descriptor of the directory, or -1 on error
+ */
+static int open_parent(int dest_fd, char *path, const char **leaf) {
+  int dir = dup(dest_fd);
+  char *p = path;
+  char *slash;
+  while (dir >= 0 && (slash = strchr(p, '/')) != NULL) {
+    *slash = '\0';
+    if (mkdirat(dir, p, 0755) != 0 && errno != EEXIST) {
+      close(dir);
+      dir = -1;
+    } else {
+      int next = openat(dir, p, O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+      close(dir);
+      dir = next;
+    }
+    *slash = '/';
+    p = slash + 1;
+  }
+  *leaf = p;
+  return dir;
+}
+
+
+/** Creates a file of the new version.
+ *  @param dest_fd Destination directory
+ *  @param path Checked path of the file
+ *  @param mode Permission bits
+ *  @param data Contents
+ *  @param len Size
+ *  @return 0 on success, -1 on error
+ */
+static int write_file(int dest_fd, char *path, mode_t mode, const void *data,
+                      size_t len) {
+  const char *leaf;
+  int dir = open_parent(dest_fd, path, &leaf);
+  if (dir < 0) return -1;
+  int fd = openat(dir, leaf, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW
+                  | O_CLOEXEC, 0600);
+  close(dir);
+  if (fd < 0) return -1;
+
+  const unsigned char *p = data;
+  size_t left = len;
+  while (left > 0) {
+    ssize_t n = write(fd, p, left);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    p += n;
+    left -= (size_t)n;
+  }
+  int rc = left == 0 && fchmod(fd, mode) == 0 ? 0 : -1;
+  if (close(fd) != 0) rc = -1;
+  return rc;
+}
+
+
+/** Reads a base file and checks it is the one the delta was made from.
+ *  @param base_fd Installed package directory
+ *  @param path Path of the base
+ *  @param sha Its digest when published
+ *  @param len Set to its size
+ *  @return Allocated contents, or NULL if missing or different
+ */
+static unsigned char *read_base(int base_fd, const char *path,
+                                const char *sha, size_t *len) {
+  if (!pkg_files_safe_path(path)) return NULL;
+  unsigned char *data = read_file(base_fd, path, len);
+  if (data == NULL) return NULL;
+  char hex[PKG_SHA256_HEX_LEN + 1];
+  digest(data, *len, hex);
+  if (strcasecmp(hex, sha) != 0) {
+    free(data);
+    return NULL;
+  }
+  return data;
+}
+
+
+/** Decompresses a file carried by the delta and checks its digest.
+ *  @param dctx Decompression context
+ *  @param frame zstd frame
+ *  @param frame_len Size of the frame
+ *  @param prefix Base it was made against, or NULL
+ *  @param prefix_len Size of prefix
+ *  @param size Size of the file
+ *  @param sha Digest of the file
+ *  @return Allocated contents, or NULL on error or mismatch
+ */
+static unsigned char *unpack_file(ZSTD_DCtx *dctx, const void *frame,
+                                  size_t frame_len, const void *prefix,
+                                  size_t prefix_len, size_t size,
+                                  const char *sha) {
+  ZSTD_DCtx_reset(dctx, ZSTD_reset_session_and_parameters);
+  ZSTD_DCtx_setParameter(dctx, ZSTD_d_windowLogMax, DELTA_MAX_WINDOW_LOG);
+  if (prefix != NULL &&
+      ZSTD_isError(ZSTD_DCtx_refPrefix(dctx, prefix, prefix_len))) {
+    return NULL;
+  }
+
+  unsigned char *out = malloc(size > 0 ? size : 1);
+  if (out == NULL) return NULL;
+  size_t n = ZSTD_decompressDCtx(dctx, out, size, frame, frame_len);
+  char hex[PKG_SHA256_HEX_LEN + 1];
+  if (ZSTD_isError(n) || n != size ||
+      (digest(out, size, hex), strcasecmp(hex, sha) != 0)) {
+    free(out);
+    return NULL;
+  }
+  return out;
+}
+
+
+/** Applies one record.
+ *  @param c Cursor just past the record's type
+ *  @param op Record type
+ *  @param base_fd Installed package directory
+ *  @param dest_fd Directory being filled
+ *  @param dctx Decompression context
+ *  @return 0 on success, -1 on error
+ */
+static int apply_record(cursor_t *c, int op, int base_fd, int dest_fd,
+                        ZSTD_DCtx *dctx) {
+  char *path = get_str(c);
+  if (path == NULL || !pkg_files_safe_path(path)) {
+    free(path);
+    return -1;
+  }
+
+  int rc = -1;
+  const char *leaf;
+  if (op == 'D') {
+    mode_t mode = (mode_t)get_uint(c, 4) & 0777;
+    int dir = c->bad ? -1 : open_parent(dest_fd, path, &leaf);
+    if (dir >= 0) {
+      rc = mkdirat(dir, leaf, mode | 0700) == 0 || errno == EEXIST ? 0 : -1;
+      close(dir);
+    }
+  } else if (op == 'L') {
+    char *target = get_str(c);
+    int dir = target != NULL ? open_parent(dest_fd, path, &leaf) : -1;
+    if (dir >= 0) {
+      rc = symlinkat(target, dir, leaf);
+      close(dir);
+    }
+    free(target);
+  } else if (op == 'C' || op == 'P' || op == 'F') {
+    mode_t mode = (mode_t)get_uint(c, 4) & 0777;
+    char *base_path = op != 'F' ? get_str(c) : NULL;
+    char base_sha[PKG_SHA256_HEX_LEN + 1];
+    char new_sha[PKG_SHA256_HEX_LEN + 1];
+    int ok = (op == 'F' || (base_path != NULL &&
+                            get_digest(c, base_sha) == 0)) &&
+             (op == 'C' || get_digest(c, new_sha) == 0);
+
+    size_t base_len = 0;
+    unsigned char *base = ok && op != 'F'
+                          ? read_base(base_fd, base_path, base_sha, &base_len)
+                          : NULL;
+    if (op == 'C') {
+      if (base != NULL) {
+        rc = write_file(dest_fd, path, mode, base, base_len);
+      }
+    } else if (ok && (op == 'F' || base != NULL)) {
+      uint64_t size = get_uint(c, 8);
+      uint64_t frame_len = get_uint(c, 8);
+      const unsigned char *frame = get_bytes(c, frame_len);
+      unsigned char *data = frame != NULL && size <= DELTA_MAX_FILE
+                            ? unpack_file(dctx, frame, frame_len, base,
+                                          base_len, size, new_sha)
+                            : NULL;
+      if (data != NULL) {
+        rc = write_file(dest_fd, path, mode, data, size);
+        free(data);
+      }
+    }
+    free(base);
+    free(base_path);
+  }
+
+  free(path);
+  return c->bad ? -1 : rc;
+}
+
+
+/** Rebuilds a package from a delta and its installed older version.
+ *  @param delta The delta
+ *  @param len Its size
+ *  @param base_dir Installed package directory
+ *  @param dest_dir Empty directory to fill
+ *  @return 0 on success, -1 on error
+ */
+int pkg_delta_apply(const void *delta, size_t len, const char *base_dir,
+                    const char *dest_dir) {
+  cursor_t c = { .p = delta, .end = (const unsigned char *)delta + len };
+  const unsigned char *magic = get_bytes(&c, DELTA_MAGIC_LEN);
+  if (magic == NULL || memcmp(magic, DELTA_MAGIC, DELTA_MAGIC_LEN) != 0) {
+    return -1;
+  }
+
+  int base_fd = open(base_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  int dest_fd = open(dest_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  ZSTD_DCtx *dctx = ZSTD_createDCtx();
+  int rc = base_fd >= 0 && dest_fd >= 0 && dctx != NULL ? 0 : -1;
+
+  int op = 0;
+  while (rc == 0 && (op = (int)get_uint(&c, 1)) != 'E' && !c.bad) {
+    rc = apply_record(&c, op, base_fd, dest_fd, dctx);
+  }
+  if (rc == 0 && (op != 'E' || c.p != c.end)) {
+    rc = -1;
+  }
+
+  ZSTD_freeDCtx(dctx);
+  if (base_fd >= 0) close(base_fd);
+  if (dest_fd >= 0) close(dest_fd);
+  return rc;
+}
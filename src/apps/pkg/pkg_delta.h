@@ -0,0 +1,32 @@
+#ifndef PKG_DELTA_H
+#define PKG_DELTA_H
+
+#include <stddef.h>
+
+// Binary deltas between published versions of a package
+//
+// A delta rebuilds a new version of a package from the files of an
+// installed older one, so pkg upgrade downloads what changed instead of
+// the whole tarball. Unchanged files (also under another name) are
+// copied from the installed version, changed ones are patched with zstd
+// using the old file as a prefix (as `zstd --patch-from` does), and new
+// ones are carried whole, zstd-compressed. Every record carries the
+// SHA-256 of the file it reads and of the file it writes, so a delta
+// applied to an installed copy that differs from the published one fails
+// instead of producing a wrong package.
+
+// Write the delta from package directory old_dir to new_dir to fd.
+// When old_dir has a Makefile, the files installing it rewrites (see
+// pkg_files_private) are not used as bases.
+// Returns 0 on success, -1 on error (printed)
+int pkg_delta_create(int fd, const char *old_dir, const char *new_dir);
+
+// Rebuild a package from a delta and the installed package in base_dir
+// into dest_dir, which must exist and be empty
+// Returns 0 on success, -1 if the delta is malformed, a base file is
+// missing or differs from the one the delta was made from, or a file
+// could not be written
+int pkg_delta_apply(const void *delta, size_t len, const char *base_dir,
+                    const char *dest_dir);
+
+#endif
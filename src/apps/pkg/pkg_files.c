@@ -0,0 +1,437 @@
+/** @file pkg_files.c
+ *  @brief Per-file digests: scanning, manifest hashes, checks and the
+ *         shared file store.
+ *
+ *  A package directory is scanned with jbox_walk(), whose threads also
+ *  hash the regular files they find, so hashing a source tree runs on
+ *  every core. The store holds one hard link per distinct file, named by
+ *  its digest; a file is shared only when the store's copy has the same
+ *  permissions, since those belong to the inode too. A store entry whose
+ *  link count has dropped to one belongs to no package any more.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "pkg_files.h"
+#include "pkg_utils.h"
+#include "utils/jbox_hash.h"
+#include "utils/jbox_json.h"
+#include "utils/jbox_walk.h"
+
+
+/** Bytes read at a time while hashing. */
+#define HASH_CHUNK (256 * 1024)
+
+
+/** State shared by the walker threads of a scan. */
+typedef struct {
+  const struct stat *skip;
+  PkgFileList *list;
+  size_t cap;
+  int failed;
+  pthread_mutex_t lock;
+} scan_t;
+
+
+/** Hashes the rest of a file.
+ *  @param fd Open file
+ *  @param hex Set to the hex digest
+ *  @return 0 on success, -1 on read error or allocation failure
+ */
+static int hash_fd(int fd, char hex[PKG_SHA256_HEX_LEN + 1]) {
+  unsigned char *buf = malloc(HASH_CHUNK);
+  if (buf == NULL) return -1;
+
+  jbox_sha256_t md;
+  jbox_sha256_init(&md);
+  ssize_t n;
+  while ((n = read(fd, buf, HASH_CHUNK)) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      free(buf);
+      return -1;
+    }
+    jbox_sha256_update(&md, buf, (size_t)n);
+  }
+  free(buf);
+
+  uint8_t digest[JBOX_SHA256_LEN];
+  jbox_sha256_final(&md, digest);
+  jbox_hash_hex(digest, sizeof(digest), hex);
+  return 0;
+}
+
+
+/** Reports an entry that could not be read.
+ *  @param scan Scan state
+ *  @param path Path of the entry
+ *  @param err errno value
+ */
+static void scan_fail(scan_t *scan, const char *path, int err) {
+  fprintf(stderr, "pkg build: cannot read %s: %s\n", path, strerror(err));
+  pthread_mutex_lock(&scan->lock);
+  scan->failed = 1;
+  pthread_mutex_unlock(&scan->lock);
+}
+
+
+/** Reads and hashes one entry; called from every walker thread.
+ *  @param entry Entry found
+ *  @param arg The scan_t
+ *  @return JBOX_WALK_CONTINUE, or JBOX_WALK_STOP if out of memory
+ */
+static int scan_visit(jbox_walk_entry_t *entry, void *arg) {
+  scan_t *scan = arg;
+  if (entry->depth == 0) return JBOX_WALK_CONTINUE;
+
+  struct stat st;
+  if (fstatat(entry->dir_fd, entry->name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+    scan_fail(scan, entry->path, errno);
+    return JBOX_WALK_SKIP;
+  }
+  if (scan->skip != NULL && st.st_dev == scan->skip->st_dev &&
+      st.st_ino == scan->skip->st_ino) {
+    return JBOX_WALK_CONTINUE;
+  }
+
+  PkgFileEntry e = {
+    .mode = st.st_mode & 07777,
+    .mtime = st.st_mtime,
+  };
+  if (S_ISDIR(st.st_mode)) {
+    e.type = DT_DIR;
+  } else if (S_ISREG(st.st_mode)) {
+    e.type = DT_REG;
+    int fd = openat(entry->dir_fd, entry->name,
+                    O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0 || hash_fd(fd, e.sha256) != 0) {
+      scan_fail(scan, entry->path, errno);
+      if (fd >= 0) close(fd);
+      return JBOX_WALK_CONTINUE;
+    }
+    close(fd);
+    e.size = (uint64_t)st.st_size;
+  } else if (S_ISLNK(st.st_mode)) {
+    e.type = DT_LNK;
+    char target[4096];
+    ssize_t n = readlinkat(entry->dir_fd, entry->name, target,
+                           sizeof(target) - 1);
+    if (n < 0) {
+      scan_fail(scan, entry->path, errno);
+      return JBOX_WALK_CONTINUE;
+    }
+    target[n] = '\0';
+    e.link = strdup(target);
+    if (e.link == NULL) goto oom;
+  } else {
+    return JBOX_WALK_CONTINUE;
+  }
+
+  e.path = strdup(entry->rel);
+  if (e.path == NULL) goto oom;
+
+  pthread_mutex_lock(&scan->lock);
+  PkgFileList *list = scan->list;
+  if (list->count == scan->cap) {
+    size_t cap = scan->cap ? scan->cap * 2 : 64;
+    PkgFileEntry *items = realloc(list->items, cap * sizeof(PkgFileEntry));
+    if (items == NULL) {
+      pthread_mutex_unlock(&scan->lock);
+      goto oom;
+    }
+    list->items = items;
+    scan->cap = cap;
+  }
+  list->items[list->count++] = e;
+  pthread_mutex_unlock(&scan->lock);
+  return JBOX_WALK_CONTINUE;
+
+oom:
+  free(e.path);
+  free(e.link);
+  scan_fail(scan, entry->path, ENOMEM);
+  return JBOX_WALK_STOP;
+}
+
+
+/** Reports a directory the walker could not read.
+ *  @param path Path of the directory
+ *  @param err errno value
+ *  @param arg The scan_t
+ */
+static void scan_error(const char *path, int err, void *arg) {
+  scan_fail(arg, path, err);
+}
+
+
+static int compare_entries(const void *a, const void *b) {
+  return jbox_walk_compare_paths(((const PkgFileEntry *)a)->path,
+                                 ((const PkgFileEntry *)b)->path);
+}
+
+
+/** Scans a package directory.
+ *  @param dir Directory to scan
+ *  @param skip File to leave out, or NULL
+ *  @param list Set to the entries, sorted by path
+ *  @return 0 on success, -1 on error
+ */
+int pkg_files_scan(const char *dir, const struct stat *skip,
+                   PkgFileList *list) {
+  list->items = NULL;
+  list->count = 0;
+
+  scan_t scan = { .skip = skip, .list = list };
+  pthread_mutex_init(&scan.lock, NULL);
+  jbox_walk_options_t opts = {
+    .max_depth = -1,
+    .visit = scan_visit,
+    .error = scan_error,
+    .arg = &scan,
+  };
+  int rc = jbox_walk(dir, &opts);
+  pthread_mutex_destroy(&scan.lock);
+
+  if (rc != 0 || scan.failed) {
+    pkg_files_free(list);
+    return -1;
+  }
+  qsort(list->items, list->count, sizeof(PkgFileEntry), compare_entries);
+  return 0;
+}
+
+
+/** Frees the entries of a list.
+ *  @param list List to free
+ */
+void pkg_files_free(PkgFileList *list) {
+  for (size_t i = 0; i < list->count; i++) {
+    free(list->items[i].path);
+    free(list->items[i].link);
+  }
+  free(list->items);
+  list->items = NULL;
+  list->count = 0;
+}
+
+
+/** Adds file digests to a manifest.
+ *  The text is kept as written and the member inserted before the
+ *  closing brace; a "hashes" member already there (a package rebuilt
+ *  from an installed copy) is shadowed, as the last one read wins.
+ *  @param json Manifest text
+ *  @param list Scanned package contents
+ *  @return Allocated JSON text, or NULL on error. Caller must free.
+ */
+char *pkg_files_manifest(const char *json, const PkgFileList *list) {
+  const char *brace = strrchr(json, '}');
+  if (brace == NULL) return NULL;
+  const char *end = brace;
+  while (end > json && isspace((unsigned char)end[-1])) end--;
+  int empty = end > json && end[-1] == '{';
+
+  char *out = NULL;
+  size_t out_len = 0;
+  FILE *f = open_memstream(&out, &out_len);
+  if (f == NULL) return NULL;
+
+  fwrite(json, 1, (size_t)(end - json), f);
+  fputs(empty ? "\n  \"hashes\": {" : ",\n  \"hashes\": {", f);
+  int first = 1;
+  for (size_t i = 0; i < list->count; i++) {
+    const PkgFileEntry *e = &list->items[i];
+    if (e->type != DT_REG || strcmp(e->path, "pkg.json") == 0) continue;
+    fputs(first ? "\n    " : ",\n    ", f);
+    jbox_json_write_string(f, e->path);
+    fprintf(f, ": \"%s\"", e->sha256);
+    first = 0;
+  }
+  fputs(first ? "}\n}\n" : "\n  }\n}\n", f);
+
+  if (fclose(f) != 0) {
+    free(out);
+    return NULL;
+  }
+  return out;
+}
+
+
+/** Checks that a manifest path stays inside the package.
+ *  @param path Path from the manifest
+ *  @return 1 if it is relative and has no ".." component, 0 otherwise
+ */
+int pkg_files_safe_path(const char *path) {
+  if (path[0] == '\0' || path[0] == '/') return 0;
+  for (const char *p = path; *p; ) {
+    const char *slash = strchr(p, '/');
+    size_t len = slash ? (size_t)(slash - p) : strlen(p);
+    if (len == 2 && p[0] == '.' && p[1] == '.') return 0;
+    p += len;
+    if (*p == '/') p++;
+  }
+  return 1;
+}
+
+
+/** Checks the files of an extracted package against its manifest.
+ *  @param dir Package directory
+ *  @param m Manifest, with hashes
+ *  @param bad Set to the first path that does not match
+ *  @return 0 if all match, -1 otherwise
+ */
+int pkg_files_verify(const char *dir, const PkgManifest *m,
+                     const char **bad) {
+  int dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd < 0) {
+    *bad = dir;
+    return -1;
+  }
+
+  int result = 0;
+  for (int i = 0; i < m->hashes_count && result == 0; i++) {
+    char hex[PKG_SHA256_HEX_LEN + 1];
+    int fd = pkg_files_safe_path(m->hash_paths[i])
+             ? openat(dir_fd, m->hash_paths[i],
+                      O_RDONLY | O_NOFOLLOW | O_CLOEXEC)
+             : -1;
+    if (fd < 0 || hash_fd(fd, hex) != 0 ||
+        strcasecmp(hex, m->hashes[i]) != 0) {
+      *bad = m->hash_paths[i];
+      result = -1;
+    }
+    if (fd >= 0) close(fd);
+  }
+  close(dir_fd);
+  return result;
+}
+
+
+/** Builds the store path of a digest.
+ *  @param store Store directory
+ *  @param sha256 Hex digest, checked by the caller
+ *  @return Allocated path, or NULL on allocation failure
+ */
+static char *store_path(const char *store, const char *sha256) {
+  size_t len = strlen(store) + 1 + PKG_SHA256_HEX_LEN + 1;
+  char *path = malloc(len);
+  if (path != NULL) {
+    int n = snprintf(path, len, "%s/", store);
+    for (int i = 0; i < PKG_SHA256_HEX_LEN; i++) {
+      path[n + i] = (char)tolower((unsigned char)sha256[i]);
+    }
+    path[n + PKG_SHA256_HEX_LEN] = '\0';
+  }
+  return path;
+}
+
+
+/** Whether a digest is 64 hex digits. */
+static int valid_digest(const char *s) {
+  size_t i = 0;
+  for (; s[i]; i++) {
+    if (!isxdigit((unsigned char)s[i])) return 0;
+  }
+  return i == PKG_SHA256_HEX_LEN;
+}
+
+
+/** Whether a file is changed in place by installing or compiling.
+ *  @param m Manifest
+ *  @param path Path of the file in the package
+ *  @return 1 for executables listed under "files" and object files
+ */
+int pkg_files_private(const PkgManifest *m, const char *path) {
+  for (int i = 0; i < m->files_count; i++) {
+    if (strcmp(m->files[i], path) == 0) return 1;
+  }
+  size_t len = strlen(path);
+  return len > 2 && path[len - 2] == '.' &&
+         (path[len - 1] == 'o' || path[len - 1] == 'a');
+}
+
+
+/** Shares the files of an installed package through the store.
+ *  @param dir Installed package directory
+ *  @param m Its manifest, verified against it
+ */
+void pkg_files_dedup(const char *dir, const PkgManifest *m) {
+  if (m->hashes_count == 0 || pkg_ensure_store_dir() != 0) return;
+  char *store = pkg_get_store_dir();
+  if (store == NULL) return;
+
+  for (int i = 0; i < m->hashes_count; i++) {
+    const char *rel = m->hash_paths[i];
+    if (!pkg_files_safe_path(rel) || !valid_digest(m->hashes[i]) ||
+        pkg_files_private(m, rel)) {
+      continue;
+    }
+
+    size_t len = strlen(dir) + strlen(rel) + 2;
+    char *path = malloc(len);
+    char *shared = store_path(store, m->hashes[i]);
+    if (path == NULL || shared == NULL) {
+      free(path);
+      free(shared);
+      break;
+    }
+    snprintf(path, len, "%s/%s", dir, rel);
+
+    struct stat st, sst;
+    if (lstat(path, &st) == 0 && S_ISREG(st.st_mode) && st.st_nlink == 1) {
+      if (link(path, shared) == 0) {
+        // First copy: the package's file becomes the store's
+      } else if (errno == EEXIST && lstat(shared, &sst) == 0 &&
+                 S_ISREG(sst.st_mode) && sst.st_size == st.st_size &&
+                 (sst.st_mode & 07777) == (st.st_mode & 07777)) {
+        // Swap in a link to the store's copy, atomically
+        size_t tmp_len = len + strlen(".pkg-link");
+        char *tmp = malloc(tmp_len);
+        if (tmp != NULL) {
+          snprintf(tmp, tmp_len, "%s.pkg-link", path);
+          unlink(tmp);
+          if (link(shared, tmp) == 0 && rename(tmp, path) != 0) {
+            unlink(tmp);
+          }
+          free(tmp);
+        }
+      }
+    }
+    free(path);
+    free(shared);
+  }
+  free(store);
+}
+
+
+/** Drops store entries only a removed package linked to.
+ *  @param m Manifest of the removed package
+ */
+void pkg_files_release(const PkgManifest *m) {
+  if (m->hashes_count == 0) return;
+  char *store = pkg_get_store_dir();
+  if (store == NULL) return;
+
+  for (int i = 0; i < m->hashes_count; i++) {
+    if (!valid_digest(m->hashes[i])) continue;
+    char *shared = store_path(store, m->hashes[i]);
+    if (shared == NULL) break;
+    struct stat st;
+    if (lstat(shared, &st) == 0 && S_ISREG(st.st_mode) && st.st_nlink == 1) {
+      unlink(shared);
+    }
+    free(shared);
+  }
+  free(store);
+}
@@ -0,0 +1,77 @@
+#ifndef PKG_FILES_H
+#define PKG_FILES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "pkg_json.h"
+
+// Per-file SHA-256 digests of package contents
+//
+// pkg build records the digest of every regular file it packs in the
+// "hashes" member of the pkg.json inside the tarball. Installs check the
+// extracted files against those digests, and keep one copy of each
+// distinct file in ~/.jshell/pkgs/_store, hard-linked into every package
+// that ships it, so versions and packages sharing sources, headers and
+// docs do not each hold their own.
+
+#define PKG_SHA256_HEX_LEN 64
+
+typedef struct {
+  char *path;               // Below the scanned directory, '/'-separated
+  unsigned char type;       // DT_REG, DT_DIR or DT_LNK
+  mode_t mode;              // Permission bits
+  uint64_t size;            // Bytes, for regular files
+  int64_t mtime;
+  char *link;               // Target, for symlinks
+  char sha256[PKG_SHA256_HEX_LEN + 1];  // Hex digest, for regular files
+} PkgFileEntry;
+
+typedef struct {
+  PkgFileEntry *items;
+  size_t count;
+} PkgFileList;
+
+// Walk dir on all cores, hashing regular files on the walker threads as
+// they are found; other file types (fifos, sockets, devices) are left
+// out. Entries are sorted by path and exclude dir itself, and the file
+// skip refers to (by device and inode; may be NULL), so a tarball being
+// written inside dir is not packed into itself.
+// Returns 0 on success, -1 if an entry could not be read (printed)
+int pkg_files_scan(const char *dir, const struct stat *skip,
+                   PkgFileList *list);
+
+// Free the entries of a list
+void pkg_files_free(PkgFileList *list);
+
+// Copy a manifest with the digests of the regular files in list, other
+// than pkg.json itself, added as its "hashes" member
+// Returns allocated JSON text, or NULL if json is not an object or on
+// allocation failure
+char *pkg_files_manifest(const char *json, const PkgFileList *list);
+
+// Check the files of an extracted package against its manifest
+// Returns 0 if every digest matches, -1 otherwise with *bad set to the
+// path that did not (pointing into m)
+int pkg_files_verify(const char *dir, const PkgManifest *m,
+                     const char **bad);
+
+// Link the files of an installed package to identical files in the
+// store, adding those it does not have yet. Executables listed under
+// "files" and object files are left alone, as installing and compiling
+// the package change them in place. Failures only leave files unshared.
+void pkg_files_dedup(const char *dir, const PkgManifest *m);
+
+// Whether a path from a manifest is relative and has no ".." component
+int pkg_files_safe_path(const char *path);
+
+// Whether installing or compiling a package changes one of its files in
+// place: executables listed under "files" and object files
+int pkg_files_private(const PkgManifest *m, const char *path);
+
+// Drop the store's copies of a removed package's files that no other
+// package links to any more
+void pkg_files_release(const PkgManifest *m);
+
+#endif
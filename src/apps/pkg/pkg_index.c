@@ -0,0 +1,402 @@
+/** @file pkg_index.c
+ *  @brief Binary command index for installed packages.
+ *
+ *  pkg writes the index every time it saves the package database; the
+ *  shell maps it and looks commands up by binary search instead of parsing
+ *  the JSON at startup. The header records the size and mtime of the
+ *  pkgdb.json and journal it was built from, so an index left behind by a
+ *  tool that only changed the database is detected and rebuilt.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pkg_index.h"
+#include "pkg_utils.h"
+
+
+/** One command collected while building the index. */
+typedef struct {
+  const char *name;
+  const char *summary;
+  size_t seq;              // Position in the database, earlier wins
+} IndexItem;
+
+
+/** Orders items by name, then by database position.
+ *  @param a First IndexItem
+ *  @param b Second IndexItem
+ *  @return Comparison result for qsort
+ */
+static int compare_items(const void *a, const void *b) {
+  const IndexItem *x = a;
+  const IndexItem *y = b;
+  int cmp = strcmp(x->name, y->name);
+  if (cmp != 0) {
+    return cmp;
+  }
+  return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+
+/** Reads the size and mtime of pkgdb.json and its journal.
+ *  @param size Set to their combined size, or -1 if neither exists
+ *  @param mtime_ns Set to the later modification time in nanoseconds
+ */
+static void stat_db(int64_t *size, int64_t *mtime_ns) {
+  *size = -1;
+  *mtime_ns = 0;
+
+  char *db_path = pkg_get_db_path();
+  if (db_path == NULL) {
+    return;
+  }
+
+  struct stat st;
+  if (stat(db_path, &st) == 0) {
+    *size = (int64_t)st.st_size;
+    *mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000
+                + st.st_mtim.tv_nsec;
+  }
+  free(db_path);
+
+  char *journal_path = pkg_get_journal_path();
+  if (journal_path != NULL && stat(journal_path, &st) == 0) {
+    int64_t mtime = (int64_t)st.st_mtim.tv_sec * 1000000000
+                    + st.st_mtim.tv_nsec;
+    *size = (*size < 0 ? 0 : *size) + (int64_t)st.st_size;
+    if (mtime > *mtime_ns) {
+      *mtime_ns = mtime;
+    }
+  }
+  free(journal_path);
+}
+
+
+/** Writes a buffer to a descriptor, retrying short writes.
+ *  @param fd Descriptor to write to
+ *  @param buf Data
+ *  @param len Length of data
+ *  @return 0 on success, -1 on error
+ */
+static int write_all(int fd, const void *buf, size_t len) {
+  const char *p = buf;
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+
+/** Writes the command index for a package database.
+ *  Each installed file contributes a command named after its basename,
+ *  described by its package's description. The file is written to a
+ *  temporary name and renamed, so a mapped old index stays intact.
+ *  @param db Package database
+ *  @return 0 on success, -1 on error
+ */
+int pkg_index_write(const PkgDb *db) {
+  if (db == NULL || pkg_ensure_dirs() != 0) {
+    return -1;
+  }
+
+  size_t total = 0;
+  for (int i = 0; i < db->count; i++) {
+    total += (size_t)db->entries[i].files_count;
+  }
+
+  IndexItem *items = malloc((total > 0 ? total : 1) * sizeof(IndexItem));
+  if (items == NULL) {
+    return -1;
+  }
+
+  size_t n = 0;
+  for (int i = 0; i < db->count; i++) {
+    const PkgDbEntry *entry = &db->entries[i];
+    for (int j = 0; j < entry->files_count; j++) {
+      const char *file = entry->files[j];
+      const char *slash = strrchr(file, '/');
+      const char *name = slash ? slash + 1 : file;
+      if (*name == '\0') {
+        continue;
+      }
+      items[n].name = name;
+      items[n].summary = entry->description;
+      items[n].seq = n;
+      n++;
+    }
+  }
+  qsort(items, n, sizeof(IndexItem), compare_items);
+
+  // Drop later duplicates; the first package to provide a name keeps it
+  size_t unique = 0;
+  size_t strings_size = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (unique > 0 && strcmp(items[unique - 1].name, items[i].name) == 0) {
+      continue;
+    }
+    items[unique++] = items[i];
+    strings_size += strlen(items[i].name) + 1;
+    if (items[i].summary != NULL) {
+      strings_size += strlen(items[i].summary) + 1;
+    }
+  }
+
+  size_t strings_offset = sizeof(PkgIndexHeader)
+                          + unique * sizeof(PkgIndexEntry);
+  size_t file_size = strings_offset + strings_size;
+  if (file_size >= PKG_INDEX_NO_STRING) {
+    free(items);
+    return -1;
+  }
+
+  char *buf = calloc(1, file_size);
+  if (buf == NULL) {
+    free(items);
+    return -1;
+  }
+
+  PkgIndexHeader *header = (PkgIndexHeader *)buf;
+  memcpy(header->magic, PKG_INDEX_MAGIC, sizeof(header->magic));
+  header->count = (uint32_t)unique;
+  header->strings_offset = (uint32_t)strings_offset;
+  stat_db(&header->db_size, &header->db_mtime_ns);
+
+  PkgIndexEntry *entries = (PkgIndexEntry *)(buf + sizeof(PkgIndexHeader));
+  size_t pos = 0;
+  char *strings = buf + strings_offset;
+  for (size_t i = 0; i < unique; i++) {
+    size_t len = strlen(items[i].name) + 1;
+    memcpy(strings + pos, items[i].name, len);
+    entries[i].name = (uint32_t)pos;
+    pos += len;
+
+    entries[i].summary = PKG_INDEX_NO_STRING;
+    if (items[i].summary != NULL) {
+      len = strlen(items[i].summary) + 1;
+      memcpy(strings + pos, items[i].summary, len);
+      entries[i].summary = (uint32_t)pos;
+      pos += len;
+    }
+  }
+  free(items);
+
+  char *index_path = pkg_get_index_path();
+  if (index_path == NULL) {
+    free(buf);
+    return -1;
+  }
+
+  size_t tmp_len = strlen(index_path) + 32;
+  char *tmp_path = malloc(tmp_len);
+  if (tmp_path == NULL) {
+    free(index_path);
+    free(buf);
+    return -1;
+  }
+  snprintf(tmp_path, tmp_len, "%s.tmp.%ld", index_path, (long)getpid());
+
+  int result = -1;
+  int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd >= 0) {
+    int written = write_all(fd, buf, file_size);
+    if (close(fd) == 0 && written == 0
+        && rename(tmp_path, index_path) == 0) {
+      result = 0;
+    }
+    if (result != 0) {
+      unlink(tmp_path);
+    }
+  }
+
+  free(tmp_path);
+  free(index_path);
+  free(buf);
+  return result;
+}
+
+
+/** Maps the command index and checks it against pkgdb.json.
+ *  @param idx Index to fill in
+ *  @return 0 on success, -1 if missing, malformed or out of date
+ */
+int pkg_index_open(PkgIndex *idx) {
+  memset(idx, 0, sizeof(*idx));
+
+  char *index_path = pkg_get_index_path();
+  if (index_path == NULL) {
+    return -1;
+  }
+
+  int fd = open(index_path, O_RDONLY | O_CLOEXEC);
+  free(index_path);
+  if (fd < 0) {
+    return -1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(PkgIndexHeader)) {
+    close(fd);
+    return -1;
+  }
+
+  size_t size = (size_t)st.st_size;
+  void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return -1;
+  }
+
+  const PkgIndexHeader *header = map;
+  size_t entries_end = sizeof(PkgIndexHeader)
+                       + (size_t)header->count * sizeof(PkgIndexEntry);
+  const char *base = map;
+
+  // The last byte must end a string, so any in-range offset is terminated
+  bool valid = memcmp(header->magic, PKG_INDEX_MAGIC,
+                      sizeof(header->magic)) == 0
+               && header->strings_offset >= entries_end
+               && header->strings_offset <= size
+               && (header->count == 0 || (header->strings_offset < size
+                                          && base[size - 1] == '\0'));
+
+  int64_t db_size;
+  int64_t db_mtime_ns;
+  stat_db(&db_size, &db_mtime_ns);
+  if (!valid || db_size != header->db_size
+      || (db_size >= 0 && db_mtime_ns != header->db_mtime_ns)) {
+    munmap(map, size);
+    return -1;
+  }
+
+  idx->map = map;
+  idx->map_size = size;
+  idx->header = header;
+  idx->entries = (const PkgIndexEntry *)(base + sizeof(PkgIndexHeader));
+  idx->strings = base + header->strings_offset;
+  idx->strings_size = size - header->strings_offset;
+  idx->dev = st.st_dev;
+  idx->ino = st.st_ino;
+  return 0;
+}
+
+
+/** Unmaps an index.
+ *  @param idx Index opened with pkg_index_open (may be unopened)
+ */
+void pkg_index_close(PkgIndex *idx) {
+  if (idx->map != NULL) {
+    munmap(idx->map, idx->map_size);
+  }
+  memset(idx, 0, sizeof(*idx));
+}
+
+
+/** Checks whether pkg has replaced the index or the database.
+ *  @param idx Open index
+ *  @return true if the mapping no longer matches the files on disk
+ */
+bool pkg_index_changed(const PkgIndex *idx) {
+  if (idx->map == NULL) {
+    return true;
+  }
+
+  char *index_path = pkg_get_index_path();
+  if (index_path == NULL) {
+    return true;
+  }
+
+  struct stat st;
+  int rc = stat(index_path, &st);
+  free(index_path);
+  if (rc != 0 || st.st_dev != idx->dev || st.st_ino != idx->ino) {
+    return true;
+  }
+
+  int64_t db_size;
+  int64_t db_mtime_ns;
+  stat_db(&db_size, &db_mtime_ns);
+  return db_size != idx->header->db_size
+         || (db_size >= 0 && db_mtime_ns != idx->header->db_mtime_ns);
+}
+
+
+/** Returns the number of commands in an index.
+ *  @param idx Open index
+ *  @return Command count
+ */
+size_t pkg_index_count(const PkgIndex *idx) {
+  return idx->header != NULL ? idx->header->count : 0;
+}
+
+
+/** Resolves a string table offset.
+ *  @param idx Open index
+ *  @param offset Offset into the string table
+ *  @return String, or NULL if the offset is out of range
+ */
+static const char *index_string(const PkgIndex *idx, uint32_t offset) {
+  if (offset == PKG_INDEX_NO_STRING || offset >= idx->strings_size) {
+    return NULL;
+  }
+  return idx->strings + offset;
+}
+
+
+/** Returns the command name at a position.
+ *  @param idx Open index
+ *  @param i Position, less than pkg_index_count()
+ *  @return Command name ("" if the entry is corrupt)
+ */
+const char *pkg_index_name(const PkgIndex *idx, size_t i) {
+  const char *name = index_string(idx, idx->entries[i].name);
+  return name != NULL ? name : "";
+}
+
+
+/** Returns the description of the command at a position.
+ *  @param idx Open index
+ *  @param i Position, less than pkg_index_count()
+ *  @return Description, or NULL if there is none
+ */
+const char *pkg_index_summary(const PkgIndex *idx, size_t i) {
+  return index_string(idx, idx->entries[i].summary);
+}
+
+
+/** Binary-searches an index for a command.
+ *  @param idx Open index
+ *  @param name Command name
+ *  @return Position of the command, or -1 if it is not in the index
+ */
+long pkg_index_find(const PkgIndex *idx, const char *name) {
+  size_t lo = 0;
+  size_t hi = pkg_index_count(idx);
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int cmp = strcmp(pkg_index_name(idx, mid), name);
+    if (cmp == 0) {
+      return (long)mid;
+    }
+    if (cmp < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,76 @@
+#ifndef PKG_INDEX_H
+#define PKG_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "pkg_db.h"
+
+// Binary command index kept next to pkgdb.json (~/.jshell/pkgs/pkgdb.idx)
+//
+// Layout: a PkgIndexHeader, `count` PkgIndexEntry records sorted by
+// command name, then a string table of NUL-terminated strings. The shell
+// maps the file and binary-searches it, so startup does not depend on the
+// number of installed packages.
+
+#define PKG_INDEX_MAGIC "JPKGIDX1"
+
+// Offset stored for a command without a summary
+#define PKG_INDEX_NO_STRING UINT32_MAX
+
+typedef struct {
+  char magic[8];
+  uint32_t count;            // Number of entries
+  uint32_t strings_offset;   // File offset of the string table
+  int64_t db_size;           // Size of pkgdb.json and its journal when
+                             // written, -1 if none
+  int64_t db_mtime_ns;       // Their latest modification time
+} PkgIndexHeader;
+
+typedef struct {
+  uint32_t name;             // String table offset of the command name
+  uint32_t summary;          // Offset of the description, or NO_STRING
+} PkgIndexEntry;
+
+// A mapped index
+typedef struct {
+  void *map;
+  size_t map_size;
+  const PkgIndexHeader *header;
+  const PkgIndexEntry *entries;
+  const char *strings;
+  size_t strings_size;
+  dev_t dev;                 // Identity of the mapped file, to spot a
+  ino_t ino;                 // replacement written by pkg
+} PkgIndex;
+
+// Write the index for db (called whenever the database is saved)
+// Returns 0 on success, -1 on error
+int pkg_index_write(const PkgDb *db);
+
+// Map the index; fails if it is missing, malformed or older than the
+// database, in which case the caller should rebuild it
+// Returns 0 on success, -1 on error
+int pkg_index_open(PkgIndex *idx);
+
+// Unmap an index opened with pkg_index_open
+void pkg_index_close(PkgIndex *idx);
+
+// True if the index or the database changed on disk since pkg_index_open
+bool pkg_index_changed(const PkgIndex *idx);
+
+// Number of commands in the index
+size_t pkg_index_count(const PkgIndex *idx);
+
+// Position of a command in the index, or -1 if absent
+long pkg_index_find(const PkgIndex *idx, const char *name);
+
+// Command name at position i
+const char *pkg_index_name(const PkgIndex *idx, size_t i);
+
+// Description of the command at position i, or NULL
+const char *pkg_index_summary(const PkgIndex *idx, size_t i);
+
+#endif
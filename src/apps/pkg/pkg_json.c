@@ -5,239 +5,62 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 
 #include "pkg_json.h"
 #include "pkg_utils.h"
+#include "utils/jbox_json.h"
 
 
-/** Skips whitespace characters in a string.
- *  @param s Input string
- *  @return Pointer to first non-whitespace character
+/** Frees an array of strings.
+ *  @param items Array to free (may be NULL)
+ *  @param count Number of strings in the array
  */
-static const char *skip_whitespace(const char *s) {
-  while (*s && isspace((unsigned char)*s)) {
-    s++;
-  }
-  return s;
-}
-
-
-/** Parses a JSON string value.
- *  @param p Pointer to string pointer (updated after parse)
- *  @return Allocated string value, or NULL on error. Caller must free.
- */
-static char *parse_string(const char **p) {
-  const char *s = *p;
-  s = skip_whitespace(s);
-
-  if (*s != '"') {
-    return NULL;
-  }
-  s++;
-
-  const char *start = s;
-  while (*s && *s != '"') {
-    if (*s == '\\' && *(s + 1)) {
-      s += 2;
-    } else {
-      s++;
-    }
-  }
-
-  if (*s != '"') {
-    return NULL;
-  }
-
-  size_t len = (size_t)(s - start);
-  char *result = malloc(len + 1);
-  if (result == NULL) {
-    return NULL;
-  }
-
-  size_t j = 0;
-  for (size_t i = 0; i < len; i++) {
-    if (start[i] == '\\' && i + 1 < len) {
-      i++;
-      switch (start[i]) {
-        case 'n': result[j++] = '\n'; break;
-        case 't': result[j++] = '\t'; break;
-        case 'r': result[j++] = '\r'; break;
-        case '"': result[j++] = '"'; break;
-        case '\\': result[j++] = '\\'; break;
-        default: result[j++] = start[i]; break;
-      }
-    } else {
-      result[j++] = start[i];
-    }
-  }
-  result[j] = '\0';
-
-  *p = s + 1;
-  return result;
-}
-
-
-/** Parses a JSON array of strings.
- *  @param p Pointer to string pointer (updated after parse)
- *  @param count Output parameter for array length
- *  @return Allocated array of strings, or NULL on error. Caller must free.
- */
-static char **parse_string_array(const char **p, int *count) {
-  const char *s = *p;
-  s = skip_whitespace(s);
-
-  if (*s != '[') {
-    return NULL;
-  }
-  s++;
-
-  char **items = NULL;
-  int capacity = 0;
-  *count = 0;
-
-  while (1) {
-    s = skip_whitespace(s);
-
-    if (*s == ']') {
-      s++;
-      break;
-    }
-
-    if (*count > 0) {
-      if (*s != ',') {
-        goto error;
-      }
-      s++;
-      s = skip_whitespace(s);
-    }
-
-    char *item = parse_string(&s);
-    if (item == NULL) {
-      goto error;
-    }
-
-    if (*count >= capacity) {
-      capacity = capacity == 0 ? 4 : capacity * 2;
-      char **new_items = realloc(items, (size_t)capacity * sizeof(char *));
-      if (new_items == NULL) {
-        free(item);
-        goto error;
-      }
-      items = new_items;
-    }
-
-    items[*count] = item;
-    (*count)++;
-  }
-
-  *p = s;
-  return items;
-
-error:
-  for (int i = 0; i < *count; i++) {
+static void free_string_array(char **items, int count) {
+  for (int i = 0; i < count; i++) {
     free(items[i]);
   }
   free(items);
-  *count = 0;
-  return NULL;
 }
 
 
-/** Parses a JSON key-value pair.
- *  @param p Pointer to string pointer (updated after parse)
- *  @param key Output parameter for key string (caller must free)
- *  @param value_start Output parameter pointing to value
+/** Reads the "hashes" object, mapping file paths to hex digests.
+ *  @param r Reader positioned before the object
+ *  @param m Manifest to fill in; earlier hashes are replaced
  *  @return 0 on success, -1 on error
  */
-static int parse_key_value(const char **p, char **key, const char **value_start) {
-  const char *s = *p;
-  s = skip_whitespace(s);
-
-  *key = parse_string(&s);
-  if (*key == NULL) {
-    return -1;
-  }
-
-  s = skip_whitespace(s);
-  if (*s != ':') {
-    free(*key);
-    *key = NULL;
-    return -1;
-  }
-  s++;
-
-  s = skip_whitespace(s);
-  *value_start = s;
-  *p = s;
-  return 0;
-}
-
-
-/** Skips over a JSON value without parsing.
- *  @param s Input string
- *  @return Pointer past the JSON value
- */
-static const char *skip_value(const char *s) {
-  s = skip_whitespace(s);
-
-  if (*s == '"') {
-    s++;
-    while (*s && *s != '"') {
-      if (*s == '\\' && *(s + 1)) {
-        s += 2;
-      } else {
-        s++;
-      }
-    }
-    if (*s == '"') s++;
-    return s;
-  }
-
-  if (*s == '[') {
-    s++;
-    int depth = 1;
-    while (*s && depth > 0) {
-      if (*s == '[') depth++;
-      else if (*s == ']') depth--;
-      else if (*s == '"') {
-        s++;
-        while (*s && *s != '"') {
-          if (*s == '\\' && *(s + 1)) s += 2;
-          else s++;
-        }
-        if (*s == '"') s++;
-        continue;
-      }
-      s++;
+static int read_hashes(jbox_json_reader_t *r, PkgManifest *m) {
+  free_string_array(m->hash_paths, m->hashes_count);
+  free_string_array(m->hashes, m->hashes_count);
+  m->hash_paths = NULL;
+  m->hashes = NULL;
+  m->hashes_count = 0;
+
+  jbox_json_event_t ev = jbox_json_next(r);
+  if (ev != JBOX_JSON_OBJECT_BEGIN) {
+    return jbox_json_skip(r, ev);
+  }
+
+  int cap = 0;
+  while ((ev = jbox_json_next(r)) == JBOX_JSON_KEY) {
+    if (m->hashes_count == cap) {
+      cap = cap ? cap * 2 : 16;
+      char **paths = realloc(m->hash_paths, (size_t)cap * sizeof(char *));
+      if (paths == NULL) return -1;
+      m->hash_paths = paths;
+      char **hashes = realloc(m->hashes, (size_t)cap * sizeof(char *));
+      if (hashes == NULL) return -1;
+      m->hashes = hashes;
     }
-    return s;
-  }
-
-  if (*s == '{') {
-    s++;
-    int depth = 1;
-    while (*s && depth > 0) {
-      if (*s == '{') depth++;
-      else if (*s == '}') depth--;
-      else if (*s == '"') {
-        s++;
-        while (*s && *s != '"') {
-          if (*s == '\\' && *(s + 1)) s += 2;
-          else s++;
-        }
-        if (*s == '"') s++;
-        continue;
-      }
-      s++;
+    char *path = strdup(r->text);
+    char *hash = path != NULL ? jbox_json_read_string(r) : NULL;
+    if (hash == NULL) {
+      free(path);
+      return -1;
     }
-    return s;
+    m->hash_paths[m->hashes_count] = path;
+    m->hashes[m->hashes_count++] = hash;
   }
-
-  while (*s && *s != ',' && *s != '}' && *s != ']') {
-    s++;
-  }
-  return s;
+  return ev == JBOX_JSON_OBJECT_END ? 0 : -1;
 }
 
 
@@ -251,80 +74,54 @@ PkgManifest *pkg_manifest_parse(const char *json_str) {
     return NULL;
   }
 
-  const char *s = json_str;
-  s = skip_whitespace(s);
-
-  if (*s != '{') {
-    free(m);
-    return NULL;
-  }
-  s++;
-
-  while (1) {
-    s = skip_whitespace(s);
-
-    if (*s == '}') {
-      break;
-    }
-
-    if (m->name != NULL || m->version != NULL || m->description != NULL
-        || m->files != NULL || m->docs != NULL) {
-      if (*s != ',') {
-        goto error;
-      }
-      s++;
-      s = skip_whitespace(s);
-    }
+  jbox_json_reader_t r;
+  jbox_json_reader_init(&r, json_str, strlen(json_str));
 
-    char *key = NULL;
-    const char *value_start = NULL;
+  jbox_json_event_t ev = jbox_json_next(&r);
+  int ok = ev == JBOX_JSON_OBJECT_BEGIN;
 
-    if (parse_key_value(&s, &key, &value_start) != 0) {
-      goto error;
+  while (ok && (ev = jbox_json_next(&r)) == JBOX_JSON_KEY) {
+    char **field = NULL;
+    if (strcmp(r.text, "name") == 0) {
+      field = &m->name;
+    } else if (strcmp(r.text, "version") == 0) {
+      field = &m->version;
+    } else if (strcmp(r.text, "description") == 0) {
+      field = &m->description;
+    } else if (strcmp(r.text, "platform") == 0) {
+      field = &m->platform;
     }
 
-    if (strcmp(key, "name") == 0) {
-      m->name = parse_string(&s);
-      if (m->name == NULL) {
-        free(key);
-        goto error;
-      }
-    } else if (strcmp(key, "version") == 0) {
-      m->version = parse_string(&s);
-      if (m->version == NULL) {
-        free(key);
-        goto error;
-      }
-    } else if (strcmp(key, "description") == 0) {
-      m->description = parse_string(&s);
-      if (m->description == NULL) {
-        free(key);
-        goto error;
-      }
-    } else if (strcmp(key, "files") == 0) {
-      m->files = parse_string_array(&s, &m->files_count);
-      if (m->files == NULL && m->files_count != 0) {
-        free(key);
-        goto error;
-      }
-    } else if (strcmp(key, "docs") == 0) {
-      m->docs = parse_string_array(&s, &m->docs_count);
-      if (m->docs == NULL && m->docs_count != 0) {
-        free(key);
-        goto error;
-      }
+    if (field != NULL) {
+      free(*field);
+      *field = jbox_json_read_string(&r);
+      ok = *field != NULL;
+    } else if (strcmp(r.text, "files") == 0) {
+      free_string_array(m->files, m->files_count);
+      m->files = jbox_json_read_string_array(&r, &m->files_count);
+    } else if (strcmp(r.text, "docs") == 0) {
+      free_string_array(m->docs, m->docs_count);
+      m->docs = jbox_json_read_string_array(&r, &m->docs_count);
+    } else if (strcmp(r.text, "dependencies") == 0) {
+      free_string_array(m->dependencies, m->dependencies_count);
+      m->dependencies = jbox_json_read_string_array(&r,
+                                                    &m->dependencies_count);
+    } else if (strcmp(r.text, "hashes") == 0) {
+      ok = read_hashes(&r, m) == 0;
     } else {
-      s = skip_value(s);
+      ok = jbox_json_skip(&r, jbox_json_next(&r)) == 0;
     }
-
-    free(key);
   }
 
-  return m;
+  ok = ok && ev == JBOX_JSON_OBJECT_END
+       && jbox_json_next(&r) == JBOX_JSON_DONE;
+  jbox_json_reader_free(&r);
 
-error:
-  pkg_manifest_free(m);
-  return NULL;
+  if (!ok) {
+    pkg_manifest_free(m);
+    return NULL;
+  }
+  return m;
 }
 
 
@@ -355,16 +152,13 @@ void pkg_manifest_free(PkgManifest *m) {
   free(m->name);
   free(m->version);
   free(m->description);
+  free(m->platform);
 
-  for (int i = 0; i < m->files_count; i++) {
-    free(m->files[i]);
-  }
-  free(m->files);
-
-  for (int i = 0; i < m->docs_count; i++) {
-    free(m->docs[i]);
-  }
-  free(m->docs);
+  free_string_array(m->files, m->files_count);
+  free_string_array(m->docs, m->docs_count);
+  free_string_array(m->dependencies, m->dependencies_count);
+  free_string_array(m->hash_paths, m->hashes_count);
+  free_string_array(m->hashes, m->hashes_count);
 
   free(m);
 }
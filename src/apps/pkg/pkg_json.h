@@ -5,10 +5,17 @@ typedef struct {
   char *name;
   char *version;
   char *description;
+  char *platform;          // Platform tag of a prebuilt package, or NULL
+                           // for one built from source on install
   char **files;
   int files_count;
   char **docs;
   int docs_count;
+  char **dependencies;     // Names of packages to build first
+  int dependencies_count;
+  char **hash_paths;       // Files with a recorded SHA-256, written by
+  char **hashes;           // pkg build; hashes[i] is the hex digest of
+  int hashes_count;        // hash_paths[i]
 } PkgManifest;
 
 // Parse pkg.json from a JSON string
@@ -0,0 +1,607 @@
+/** @file pkg_make.c
+ *  @brief Parallel, incremental builds of package directories.
+ *
+ *  The scheduler owns a jobserver pipe preloaded with one token per core
+ *  but one, in the format GNU make uses for its own sub-makes, and hands
+ *  its descriptors to every make it starts through MAKEFLAGS. The first
+ *  running make uses the implicit slot every make has; each further
+ *  concurrent make is only started once the scheduler has taken a token
+ *  for it, and the token goes back when that make exits. Jobs inside the
+ *  makes draw on the same tokens, so at most one job per core runs in
+ *  total however the work is split between packages.
+ *
+ *  A job waits until the jobs it depends on have settled, and the lowest
+ *  numbered job that is ready starts first; so independent packages build
+ *  side by side and each starts as soon as its dependencies are built.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "pkg_make.h"
+#include "utils/jbox_hash.h"
+
+
+extern char **environ;
+
+
+/** A make started by the scheduler. */
+typedef struct {
+  pid_t pid;
+  int job;                 // Index of its job
+  bool token;              // Whether the scheduler took a token for it
+  FILE *log;               // Its stdout and stderr
+} running_make_t;
+
+
+/** Where a job is in its run. */
+typedef enum {
+  JOB_WAITING,             // Not looked at yet, or dependencies unsettled
+  JOB_READY,               // To be built as soon as a slot is free
+  JOB_RUNNING,
+  JOB_SETTLED
+} job_state_t;
+
+
+/** Scheduling state of one run. */
+typedef struct {
+  PkgMakeJob *jobs;
+  int count;
+  job_state_t *state;
+  int *unsettled;          // Dependencies of each job not settled yet
+  const char **blocked;    // Why the job cannot be built, or NULL
+  int failed;
+  PkgMakeDone done;
+  void *ctx;
+} schedule_t;
+
+
+/** Jobserver and environment shared by the makes of one run. */
+typedef struct {
+  int fds[2];              // Jobserver pipe, or -1
+  char **envp;             // environ with the jobserver in MAKEFLAGS
+  char *makeflags;         // The MAKEFLAGS entry in envp
+} make_env_t;
+
+
+/** Gets the number of cores.
+ *  @return Online processors, at least 1
+ */
+int pkg_make_parallelism(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+}
+
+
+/** Checks whether a file name is a build input.
+ *  @param name File name
+ *  @return true for makefiles, C sources and headers, and pkg.json
+ */
+static bool is_source_name(const char *name) {
+  size_t len = strlen(name);
+  return strcmp(name, "Makefile") == 0 || strcmp(name, "makefile") == 0
+         || strcmp(name, "GNUmakefile") == 0 || strcmp(name, "pkg.json") == 0
+         || (len > 2 && (strcmp(name + len - 2, ".c") == 0
+                         || strcmp(name + len - 2, ".h") == 0))
+         || (len > 3 && strcmp(name + len - 3, ".mk") == 0);
+}
+
+
+/** Adds the build inputs under a directory to a hash, in name order.
+ *  @param md Hash being computed
+ *  @param root Package directory
+ *  @param rel Path below root ("" for root itself)
+ *  @return 0 on success, -1 on error
+ */
+static int hash_tree(jbox_sha256_t *md, const char *root, const char *rel) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s%s%s", root, rel[0] ? "/" : "", rel);
+
+  struct dirent **names;
+  int n = scandir(path, &names, NULL, alphasort);
+  if (n < 0) {
+    return -1;
+  }
+
+  int result = 0;
+  for (int i = 0; i < n; i++) {
+    const char *name = names[i]->d_name;
+    char child_rel[4096];
+    char child[8448];
+    if (name[0] == '.' || result != 0) {
+      free(names[i]);
+      continue;
+    }
+    snprintf(child_rel, sizeof(child_rel), "%s%s%s", rel, rel[0] ? "/" : "",
+             name);
+    snprintf(child, sizeof(child), "%s/%s", root, child_rel);
+
+    struct stat st;
+    if (lstat(child, &st) != 0) {
+      result = -1;
+    } else if (S_ISDIR(st.st_mode)) {
+      result = hash_tree(md, root, child_rel);
+    } else if (S_ISREG(st.st_mode) && is_source_name(name)) {
+      // The path and the size delimit each file's contents
+      char header[64];
+      int header_len = snprintf(header, sizeof(header), "%lld",
+                                (long long)st.st_size);
+      jbox_sha256_update(md, child_rel, strlen(child_rel) + 1);
+      jbox_sha256_update(md, header, (size_t)header_len + 1);
+
+      int fd = open(child, O_RDONLY | O_CLOEXEC);
+      if (fd < 0) {
+        result = -1;
+      } else {
+        char buf[16384];
+        ssize_t got;
+        while ((got = read(fd, buf, sizeof(buf))) > 0) {
+          jbox_sha256_update(md, buf, (size_t)got);
+        }
+        if (got < 0) {
+          result = -1;
+        }
+        close(fd);
+      }
+    }
+    free(names[i]);
+  }
+  free(names);
+  return result;
+}
+
+
+/** Hashes the build inputs of a package.
+ *  @param dir Package directory
+ *  @param hex Receives the SHA-256 in hex
+ *  @return 0 on success, -1 on error
+ */
+static int hash_sources(const char *dir, char hex[65]) {
+  jbox_sha256_t md;
+  jbox_sha256_init(&md);
+
+  // The toolchain settings make doesn't see in the files
+  const char *vars[] = {"CC", "CFLAGS", "LDFLAGS"};
+  for (size_t i = 0; i < sizeof(vars) / sizeof(vars[0]); i++) {
+    const char *value = getenv(vars[i]);
+    jbox_sha256_update(&md, vars[i], strlen(vars[i]) + 1);
+    if (value != NULL) {
+      jbox_sha256_update(&md, value, strlen(value));
+    }
+    jbox_sha256_update(&md, "", 1);
+  }
+
+  int result = hash_tree(&md, dir, "");
+  if (result == 0) {
+    uint8_t digest[JBOX_SHA256_LEN];
+    jbox_sha256_final(&md, digest);
+    jbox_hash_hex(digest, sizeof(digest), hex);
+  }
+  return result;
+}
+
+
+/** Builds the path of a package's build stamp.
+ *  @param dir Package directory
+ *  @param path Receives the path
+ *  @param size Size of path
+ */
+static void stamp_path(const char *dir, char *path, size_t size) {
+  snprintf(path, size, "%s/" PKG_MAKE_STAMP, dir);
+}
+
+
+/** Checks whether a package was last built from the same sources.
+ *  @param dir Package directory
+ *  @param hex Hash of its sources now
+ *  @return true if the stamp matches
+ */
+static bool stamp_matches(const char *dir, const char *hex) {
+  char path[4096];
+  stamp_path(dir, path, sizeof(path));
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    return false;
+  }
+  char line[80] = "";
+  bool match = fgets(line, sizeof(line), f) != NULL
+               && strncmp(line, hex, 64) == 0
+               && (line[64] == '\n' || line[64] == '\0');
+  fclose(f);
+  return match;
+}
+
+
+/** Records the sources of a successful build.
+ *  @param dir Package directory
+ *  @param hex Hash of the sources built
+ */
+static void stamp_write(const char *dir, const char *hex) {
+  char path[4096];
+  stamp_path(dir, path, sizeof(path));
+  FILE *f = fopen(path, "w");
+  if (f != NULL) {
+    fprintf(f, "%s\n", hex);
+    if (fclose(f) != 0) {
+      unlink(path);
+    }
+  }
+}
+
+
+/** Settles a job that needs no make, or prepares it for one.
+ *  @param job Job
+ *  @param hex Receives the hash of its sources ("" if unknown)
+ *  @return true if the job is settled, false if it must be built
+ */
+static bool settle_without_make(PkgMakeJob *job, char hex[65]) {
+  job->exit_code = 0;
+  job->log = NULL;
+  hex[0] = '\0';
+
+  struct stat st;
+  char makefile[4096];
+  snprintf(makefile, sizeof(makefile), "%s/Makefile", job->dir);
+  if (stat(makefile, &st) != 0) {
+    job->status = PKG_MAKE_NO_MAKEFILE;
+    return true;
+  }
+
+  if (hash_sources(job->dir, hex) != 0) {
+    hex[0] = '\0';
+  } else if (!job->force && stamp_matches(job->dir, hex)) {
+    job->status = PKG_MAKE_UP_TO_DATE;
+    return true;
+  }
+
+  // A failed build may leave the outputs half replaced
+  char path[4096];
+  stamp_path(job->dir, path, sizeof(path));
+  unlink(path);
+  return false;
+}
+
+
+static void make_env_free(make_env_t *env);
+
+
+/** Sets up the jobserver and the environment makes run with.
+ *  @param env Environment to fill in
+ *  @param slots Job slots in total
+ *  @return 0 on success, -1 on error (nothing to free)
+ */
+static int make_env_init(make_env_t *env, int slots) {
+  env->fds[0] = env->fds[1] = -1;
+  env->envp = NULL;
+  env->makeflags = NULL;
+
+  // Not close-on-exec: the makes inherit the pipe
+  if (pipe(env->fds) != 0) {
+    env->fds[0] = env->fds[1] = -1;
+    return -1;
+  }
+  for (int i = 1; i < slots; i++) {
+    if (write(env->fds[1], "+", 1) != 1) {
+      break;
+    }
+  }
+
+  // Keep the user's MAKEFLAGS, unless they name another jobserver
+  const char *old = getenv("MAKEFLAGS");
+  if (old == NULL || strstr(old, "jobserver") != NULL) {
+    old = "";
+  }
+  size_t len = strlen(old) + 96;
+  env->makeflags = malloc(len);
+  size_t count = 0;
+  while (environ[count] != NULL) count++;
+  env->envp = malloc((count + 2) * sizeof(char *));
+  if (env->makeflags == NULL || env->envp == NULL) {
+    make_env_free(env);
+    return -1;
+  }
+  snprintf(env->makeflags, len, "MAKEFLAGS=%s%s-j --jobserver-auth=%d,%d",
+           old, old[0] ? " " : "", env->fds[0], env->fds[1]);
+
+  size_t n = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (strncmp(environ[i], "MAKEFLAGS=", 10) != 0
+        && strncmp(environ[i], "MFLAGS=", 7) != 0) {
+      env->envp[n++] = environ[i];
+    }
+  }
+  env->envp[n++] = env->makeflags;
+  env->envp[n] = NULL;
+  return 0;
+}
+
+
+/** Closes the jobserver and frees the environment.
+ *  @param env Environment set up by make_env_init
+ */
+static void make_env_free(make_env_t *env) {
+  if (env->fds[0] >= 0) close(env->fds[0]);
+  if (env->fds[1] >= 0) close(env->fds[1]);
+  free(env->envp);
+  free(env->makeflags);
+}
+
+
+/** Starts make for a package.
+ *  @param env Jobserver environment
+ *  @param dir Package directory
+ *  @param log Receives its output
+ *  @return Process ID, or -1 on error
+ */
+static pid_t start_make(const make_env_t *env, const char *dir, FILE *log) {
+  char *argv[] = {"make", "-C", (char *)dir, NULL};
+  int log_fd = fileno(log);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    int null_fd = open("/dev/null", O_RDONLY);
+    if (null_fd >= 0) {
+      dup2(null_fd, STDIN_FILENO);
+      close(null_fd);
+    }
+    dup2(log_fd, STDOUT_FILENO);
+    dup2(log_fd, STDERR_FILENO);
+    execvpe(argv[0], argv, env->envp);
+    _exit(127);
+  }
+  return pid;
+}
+
+
+/** Reads a build log back.
+ *  @param log Log file
+ *  @return Allocated contents, or NULL if empty or on error
+ */
+static char *read_log(FILE *log) {
+  long size = ftell(log);
+  if (size <= 0 || fseek(log, 0, SEEK_SET) != 0) {
+    return NULL;
+  }
+  char *text = malloc((size_t)size + 1);
+  if (text != NULL) {
+    size_t got = fread(text, 1, (size_t)size, log);
+    text[got] = '\0';
+  }
+  return text;
+}
+
+
+/** Settles a job, and releases the jobs waiting on it.
+ *  @param sched Run
+ *  @param j Index of the job, whose status is set
+ */
+static void settle(schedule_t *sched, int j) {
+  PkgMakeJob *job = &sched->jobs[j];
+  sched->state[j] = JOB_SETTLED;
+  if (job->status == PKG_MAKE_FAILED) {
+    sched->failed++;
+  }
+  if (sched->done) sched->done(job, sched->ctx);
+
+  for (int i = 0; i < sched->count; i++) {
+    for (int d = 0; d < sched->jobs[i].deps_count; d++) {
+      if (sched->jobs[i].deps[d] == j) {
+        sched->unsettled[i]--;
+        if (job->status == PKG_MAKE_FAILED && sched->blocked[i] == NULL) {
+          sched->blocked[i] = "a dependency failed";
+        }
+      }
+    }
+  }
+}
+
+
+/** Fails a job that cannot be built, with the reason as its log.
+ *  @param sched Run
+ *  @param j Index of the job
+ *  @param reason Why it was not built
+ */
+static void settle_unbuilt(schedule_t *sched, int j, const char *reason) {
+  PkgMakeJob *job = &sched->jobs[j];
+  job->status = PKG_MAKE_FAILED;
+  job->exit_code = -1;
+  size_t len = strlen(job->name) + strlen(reason) + 16;
+  job->log = malloc(len);
+  if (job->log != NULL) {
+    snprintf(job->log, len, "%s: not built: %s\n", job->name, reason);
+  }
+  settle(sched, j);
+}
+
+
+/** Finds the lowest numbered job whose dependencies have all settled,
+ *  settling on the way any that cannot be built.
+ *  @param sched Run
+ *  @return Index of the job, or -1 if none is ready
+ */
+static int next_ready(schedule_t *sched) {
+  for (int j = 0; j < sched->count; j++) {
+    if (sched->state[j] == JOB_READY) {
+      return j;
+    }
+    if (sched->state[j] != JOB_WAITING || sched->unsettled[j] > 0) {
+      continue;
+    }
+    if (sched->blocked[j] != NULL) {
+      settle_unbuilt(sched, j, sched->blocked[j]);
+      j = -1;  // Settling may have made earlier jobs ready
+      continue;
+    }
+    return j;
+  }
+  return -1;
+}
+
+
+/** Builds package directories in parallel, respecting their dependencies.
+ *  @param jobs Jobs to run; their status and log are filled in
+ *  @param count Number of jobs
+ *  @param done Called as each job settles, or NULL
+ *  @param ctx Passed to done
+ *  @return Number of failed jobs
+ */
+int pkg_make_run(PkgMakeJob *jobs, int count, PkgMakeDone done, void *ctx) {
+  int slots = pkg_make_parallelism();
+  size_t n = (size_t)(count > 0 ? count : 1);
+  make_env_t env;
+  running_make_t *running = calloc((size_t)slots, sizeof(running_make_t));
+  char (*hashes)[65] = calloc(n, 65);
+  schedule_t sched = {
+    .jobs = jobs,
+    .count = count,
+    .state = calloc(n, sizeof(job_state_t)),
+    .unsettled = calloc(n, sizeof(int)),
+    .blocked = calloc(n, sizeof(const char *)),
+    .done = done,
+    .ctx = ctx
+  };
+  bool ready = running != NULL && hashes != NULL && sched.state != NULL
+               && sched.unsettled != NULL && sched.blocked != NULL;
+  if (!ready || make_env_init(&env, slots) != 0) {
+    for (int i = 0; i < count; i++) {
+      jobs[i].status = PKG_MAKE_FAILED;
+      jobs[i].exit_code = -1;
+      jobs[i].log = NULL;
+      if (done) done(&jobs[i], ctx);
+    }
+    free(running);
+    free(hashes);
+    free(sched.state);
+    free(sched.unsettled);
+    free(sched.blocked);
+    return count;
+  }
+
+  for (int i = 0; i < count; i++) {
+    jobs[i].log = NULL;
+    for (int d = 0; d < jobs[i].deps_count; d++) {
+      int dep = jobs[i].deps[d];
+      if (dep < 0 || dep >= count) {
+        sched.blocked[i] = "a dependency is missing";
+      } else if (dep != i) {
+        sched.unsettled[i]++;
+      }
+    }
+  }
+
+  int active = 0;
+  bool implicit_free = true;   // No running make is on the implicit slot
+
+  for (;;) {
+    // Jobs without a Makefile or with unchanged sources settle at once
+    int next;
+    while ((next = next_ready(&sched)) >= 0
+           && sched.state[next] == JOB_WAITING) {
+      if (settle_without_make(&jobs[next], hashes[next])) {
+        settle(&sched, next);
+      } else {
+        sched.state[next] = JOB_READY;
+      }
+    }
+    int settled = 0;
+    for (int i = 0; i < count; i++) {
+      settled += sched.state[i] == JOB_SETTLED;
+    }
+    if (settled == count) {
+      break;
+    }
+
+    // Nothing running and nothing ready: the rest wait on each other
+    if (next < 0 && active == 0) {
+      for (int i = 0; i < count; i++) {
+        if (sched.state[i] == JOB_WAITING) {
+          settle_unbuilt(&sched, i, "dependency cycle");
+        }
+      }
+      continue;
+    }
+
+    // Reap finished makes, giving back the tokens taken for them
+    for (int i = 0; i < active; i++) {
+      int status;
+      pid_t pid = waitpid(running[i].pid, &status, WNOHANG);
+      if (pid == 0 || (pid < 0 && errno == EINTR)) {
+        continue;
+      }
+
+      int j = running[i].job;
+      PkgMakeJob *job = &jobs[j];
+      if (pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        job->status = PKG_MAKE_OK;
+        if (hashes[j][0]) {
+          stamp_write(job->dir, hashes[j]);
+        }
+      } else {
+        job->status = PKG_MAKE_FAILED;
+        job->exit_code = pid > 0 && WIFEXITED(status) ? WEXITSTATUS(status)
+                                                      : -1;
+        job->log = read_log(running[i].log);
+      }
+      fclose(running[i].log);
+      if (running[i].token) {
+        while (write(env.fds[1], "+", 1) < 0 && errno == EINTR) {}
+      } else {
+        implicit_free = true;
+      }
+      settle(&sched, j);
+
+      running[i] = running[--active];
+      i--;
+    }
+
+    // Start the next ready build: one on make's implicit slot, the others
+    // on a token
+    bool can_start = next >= 0 && active < slots;
+    bool token = false;
+    if (can_start && !implicit_free) {
+      struct pollfd pfd = {.fd = env.fds[0], .events = POLLIN};
+      char c;
+      can_start = poll(&pfd, 1, 20) > 0 && read(env.fds[0], &c, 1) == 1;
+      token = can_start;
+    } else if (!can_start) {
+      poll(NULL, 0, 20);
+    }
+    if (!can_start) {
+      continue;
+    }
+
+    FILE *log = tmpfile();
+    pid_t pid = log ? start_make(&env, jobs[next].dir, log) : -1;
+    if (pid < 0) {
+      if (log) fclose(log);
+      if (token) {
+        while (write(env.fds[1], "+", 1) < 0 && errno == EINTR) {}
+      }
+      jobs[next].status = PKG_MAKE_FAILED;
+      jobs[next].exit_code = -1;
+      settle(&sched, next);
+    } else {
+      running[active++] = (running_make_t){pid, next, token, log};
+      sched.state[next] = JOB_RUNNING;
+      implicit_free = implicit_free && token;
+    }
+  }
+
+  make_env_free(&env);
+  free(running);
+  free(hashes);
+  free(sched.state);
+  free(sched.unsettled);
+  free(sched.blocked);
+  return sched.failed;
+}
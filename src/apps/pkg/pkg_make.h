@@ -0,0 +1,58 @@
+#ifndef PKG_MAKE_H
+#define PKG_MAKE_H
+
+#include <stdbool.h>
+
+// Building package directories with make
+//
+// pkg_make_run builds several packages at once. Up to one make per core
+// runs side by side, and all of them share a GNU make jobserver with one
+// job slot per core, so packages and the jobs inside each package
+// together keep the machine busy without overcommitting it. Each make's
+// output is collected and handed back only for failed builds.
+//
+// Jobs may depend on other jobs of the same run. A job is built only
+// after its dependencies are, and independent jobs build side by side.
+//
+// A successful build records a hash of the package's sources (makefiles,
+// *.c, *.h and pkg.json, plus CC, CFLAGS and LDFLAGS) in .pkg-build-hash in
+// its directory; a later build of the same sources is skipped.
+
+// Name of the file recording the sources of the last successful build
+#define PKG_MAKE_STAMP ".pkg-build-hash"
+
+typedef enum {
+  PKG_MAKE_OK,               // Built
+  PKG_MAKE_UP_TO_DATE,       // Sources unchanged since the last build
+  PKG_MAKE_FAILED,           // make failed or could not be run
+  PKG_MAKE_NO_MAKEFILE       // Nothing to build
+} PkgMakeStatus;
+
+typedef struct {
+  const char *name;          // Package name, for the caller
+  const char *dir;           // Directory holding the Makefile
+  bool force;                // Build even if the sources are unchanged
+  const int *deps;           // Indices of jobs to settle first, or NULL;
+                             // a negative index stands for a dependency
+                             // that is missing, and keeps the job unbuilt
+  int deps_count;
+  PkgMakeStatus status;      // Set by pkg_make_run
+  int exit_code;             // make's exit status when FAILED, else 0
+  char *log;                 // Output of a failed build, or NULL; caller
+                             // frees
+} PkgMakeJob;
+
+// Called as each job is settled, in the order they settle
+typedef void (*PkgMakeDone)(PkgMakeJob *job, void *ctx);
+
+// Number of cores, and so of concurrent builds and job slots
+int pkg_make_parallelism(void);
+
+// Build jobs, calling done (if not NULL) as each one is settled
+// A job starts once its dependencies are settled; it fails unbuilt, with
+// the reason as its log, if one of them failed or is missing or they form
+// a cycle
+// Returns the number of failed jobs
+int pkg_make_run(PkgMakeJob *jobs, int count, PkgMakeDone done, void *ctx);
+
+#endif
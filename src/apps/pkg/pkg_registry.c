@@ -6,10 +6,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <strings.h>
+#include <unistd.h>
 #include <curl/curl.h>
 
 #include "pkg_registry.h"
-#include "pkg_json.h"
+#include "pkg_search.h"
+#include "pkg_utils.h"
+#include "utils/jbox_hash.h"
+#include "utils/jbox_http.h"
+#include "utils/jbox_json.h"
 
 
 /** Buffer structure for HTTP response data. */
@@ -53,22 +59,89 @@ static size_t write_callback(void *contents, size_t size, size_t nmemb,
 }
 
 
-/** CURL write callback for writing to a file.
+/** Validators of a registry response, for conditional requests. */
+typedef struct {
+  char *etag;
+  char *last_modified;
+} validators_t;
+
+
+/** Frees the strings of a validators_t.
+ *  @param v Validators
+ */
+static void validators_free(validators_t *v) {
+  free(v->etag);
+  free(v->last_modified);
+  *v = (validators_t){0};
+}
+
+
+/** CURL header callback that picks out ETag and Last-Modified.
+ *  @param buffer Header line, not NUL-terminated
+ *  @param size Size of each element
+ *  @param nitems Number of elements
+ *  @param userp User pointer (validators_t)
+ *  @return Number of bytes processed
+ */
+static size_t header_callback(char *buffer, size_t size, size_t nitems,
+                              void *userp) {
+  validators_t *v = (validators_t *)userp;
+  size_t len = size * nitems;
+
+  // A redirect's headers are followed by the next response's
+  if (len >= 5 && strncmp(buffer, "HTTP/", 5) == 0) {
+    validators_free(v);
+    return len;
+  }
+
+  char **field = NULL;
+  size_t name_len = 0;
+  if (len > 5 && strncasecmp(buffer, "ETag:", 5) == 0) {
+    field = &v->etag;
+    name_len = 5;
+  } else if (len > 14 && strncasecmp(buffer, "Last-Modified:", 14) == 0) {
+    field = &v->last_modified;
+    name_len = 14;
+  }
+  if (field == NULL) {
+    return len;
+  }
+
+  const char *value = buffer + name_len;
+  const char *end = buffer + len;
+  while (value < end && (*value == ' ' || *value == '\t')) value++;
+  while (end > value && isspace((unsigned char)end[-1])) end--;
+  free(*field);
+  *field = end > value ? strndup(value, (size_t)(end - value)) : NULL;
+  return len;
+}
+
+
+/** Where a download's body goes. */
+typedef struct {
+  PkgDownloadSink sink;
+  void *ctx;
+} sink_target_t;
+
+
+/** CURL write callback for handing data to a download sink.
  *  @param contents Data received
  *  @param size Size of each element
  *  @param nmemb Number of elements
- *  @param userp User pointer (FILE*)
- *  @return Number of bytes written
+ *  @param userp User pointer (sink_target_t)
+ *  @return Number of bytes taken, 0 to abort the transfer
  */
-static size_t file_write_callback(void *contents, size_t size, size_t nmemb,
+static size_t sink_write_callback(void *contents, size_t size, size_t nmemb,
                                   void *userp) {
-  FILE *fp = (FILE *)userp;
-  return fwrite(contents, size, nmemb, fp);
+  sink_target_t *target = (sink_target_t *)userp;
+  size_t realsize = size * nmemb;
+  return target->sink(contents, realsize, target->ctx) == 0 ? realsize : 0;
 }
 
 
-/** Gets the package registry URL.
- *  @return Registry URL (from JSHELL_PKG_REGISTRY env var or default)
+/** Gets the configured package registry.
+ *  @return Registry URL, or several separated by spaces or commas (from
+ *          JSHELL_PKG_REGISTRY env var or default)
  */
 const char *pkg_registry_get_url(void) {
   const char *env_url = getenv("JSHELL_PKG_REGISTRY");
@@ -81,21 +154,44 @@ const char *pkg_registry_get_url(void) {
 
 /** Fetches JSON content from a URL using CURL.
  *  @param url URL to fetch
- *  @return Allocated JSON string, or NULL on error. Caller must free.
+ *  @param post JSON body to POST, or NULL to GET
+ *  @param cond Validators of a cached copy to revalidate, or NULL
+ *  @param got Receives the response's validators, or NULL
+ *  @param http_status Receives the HTTP status, or NULL
+ *  @return Allocated JSON string, or NULL on error or if the cached copy
+ *          is still current (status 304). Caller must free.
  */
-static char *fetch_json(const char *url) {
-  CURL *curl = curl_easy_init();
+static char *fetch_json(const char *url, const char *post,
+                        const validators_t *cond, validators_t *got,
+                        long *http_status) {
+  CURL *curl = jbox_http_acquire();
   if (!curl) {
     return NULL;
   }
 
+  struct curl_slist *headers = NULL;
+  if (cond && cond->etag) {
+    char line[512];
+    snprintf(line, sizeof(line), "If-None-Match: %s", cond->etag);
+    headers = curl_slist_append(headers, line);
+  }
+  if (cond && cond->last_modified) {
+    char line[512];
+    snprintf(line, sizeof(line), "If-Modified-Since: %s",
+             cond->last_modified);
+    headers = curl_slist_append(headers, line);
+  }
+  if (post) {
+    headers = curl_slist_append(headers, "Content-Type: application/json");
+  }
+
   response_buffer_t response = {
     .data = malloc(4096),
     .size = 0,
     .capacity = 4096
   };
   if (!response.data) {
-    curl_easy_cleanup(curl);
+    jbox_http_release(curl);
     return NULL;
   }
   response.data[0] = '\0';
@@ -107,15 +203,31 @@ static char *fetch_json(const char *url) {
   curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 5L);
   curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30L);
   curl_easy_setopt(curl, CURLOPT_USERAGENT, "jbox-pkg/1.0");
+  // Any encoding libcurl can decode, e.g. gzip
+  curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+  if (post) {
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post);
+  }
+  if (headers) {
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+  }
+  if (got) {
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, got);
+  }
 
   CURLcode res = curl_easy_perform(curl);
 
   long http_code = 0;
   curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
 
-  curl_easy_cleanup(curl);
+  jbox_http_release(curl);
+  curl_slist_free_all(headers);
 
-  if (res != CURLE_OK || http_code >= 400) {
+  if (http_status) {
+    *http_status = http_code;
+  }
+  if (res != CURLE_OK || http_code >= 400 || http_code == 304) {
     free(response.data);
     return NULL;
   }
@@ -124,76 +236,577 @@ static char *fetch_json(const char *url) {
 }
 
 
-/** Extracts a string value from JSON by key.
- *  @param json JSON string to search
- *  @param key Key name to find
- *  @return Allocated value string, or NULL if not found. Caller must free.
+/** Gets the path of the cached package listing.
+ *  @return Allocated path to ~/.jshell/cache/packages.cache, or NULL on
+ *          error. Caller must free.
+ */
+static char *listing_cache_path(void) {
+  char *cache_dir = pkg_get_cache_dir();
+  if (!cache_dir) return NULL;
+
+  size_t len = strlen(cache_dir) + strlen("/packages.cache") + 1;
+  char *path = malloc(len);
+  if (path) {
+    snprintf(path, len, "%s/packages.cache", cache_dir);
+  }
+  free(cache_dir);
+  return path;
+}
+
+
+/** Loads the cached package listing of a registry.
+ *  The file holds the listing URL, its ETag and its Last-Modified date on
+ *  one line each, followed by the listing as the registry sent it.
+ *  @param url Listing URL the copy must have come from
+ *  @param v Receives the validators of the copy
+ *  @return Allocated listing, or NULL if there is none for url. Caller
+ *          must free.
+ */
+static char *listing_cache_load(const char *url, validators_t *v) {
+  char *path = listing_cache_path();
+  if (!path) return NULL;
+  char *content = pkg_read_file(path);
+  free(path);
+  if (!content) return NULL;
+
+  char *lines[3];
+  char *p = content;
+  for (int i = 0; i < 3; i++) {
+    char *nl = strchr(p, '\n');
+    if (!nl) {
+      free(content);
+      return NULL;
+    }
+    *nl = '\0';
+    lines[i] = p;
+    p = nl + 1;
+  }
+
+  char *body = NULL;
+  if (strcmp(lines[0], url) == 0 && (lines[1][0] || lines[2][0])) {
+    body = strdup(p);
+    v->etag = lines[1][0] ? strdup(lines[1]) : NULL;
+    v->last_modified = lines[2][0] ? strdup(lines[2]) : NULL;
+  }
+  free(content);
+  return body;
+}
+
+
+/** Saves a package listing and its validators to the cache.
+ *  Written to a temporary file and renamed, so readers never see a
+ *  partial listing.
+ *  @param url Listing URL
+ *  @param v Validators the registry sent with it
+ *  @param body The listing
+ */
+static void listing_cache_store(const char *url, const validators_t *v,
+                                const char *body) {
+  if (pkg_ensure_cache_dir() != 0) return;
+  char *path = listing_cache_path();
+  if (!path) return;
+
+  size_t tmp_len = strlen(path) + 32;
+  char *tmp_path = malloc(tmp_len);
+  if (!tmp_path) {
+    free(path);
+    return;
+  }
+  snprintf(tmp_path, tmp_len, "%s.tmp.%ld", path, (long)getpid());
+
+  FILE *f = fopen(tmp_path, "w");
+  if (f) {
+    fprintf(f, "%s\n%s\n%s\n%s", url, v->etag ? v->etag : "",
+            v->last_modified ? v->last_modified : "", body);
+    if (fclose(f) != 0 || rename(tmp_path, path) != 0) {
+      unlink(tmp_path);
+    }
+  }
+
+  free(tmp_path);
+  free(path);
+}
+
+
+/** Fetches the registry's package listing, revalidating a cached copy.
+ *  Unchanged listings cost the registry a 304 with no body.
+ *  @param url Listing URL
+ *  @return Allocated JSON string, or NULL on error. Caller must free.
  */
-static char *json_get_string(const char *json, const char *key) {
-  char search[256];
-  snprintf(search, sizeof(search), "\"%s\"", key);
+static char *fetch_listing(const char *url) {
+  validators_t cached = {0};
+  char *cached_body = listing_cache_load(url, &cached);
+
+  validators_t got = {0};
+  long http_status = 0;
+  char *json = fetch_json(url, NULL, cached_body ? &cached : NULL, &got,
+                          &http_status);
+  if (json) {
+    if (got.etag || got.last_modified) {
+      listing_cache_store(url, &got, json);
+    }
+  } else if (http_status == 304 && cached_body) {
+    json = cached_body;
+    cached_body = NULL;
+  }
+
+  free(cached_body);
+  validators_free(&cached);
+  validators_free(&got);
+  return json;
+}
 
-  const char *key_pos = strstr(json, search);
-  if (!key_pos) return NULL;
 
-  const char *colon = strchr(key_pos + strlen(search), ':');
-  if (!colon) return NULL;
+/** Registry the requests of this process go to. */
+typedef struct {
+  char *base;             // URL requests are made against, no trailing '/'
+  bool is_static;         // Serves the static layout, named by index.json
+  char *index;            // index.json as fetched to choose it, or NULL
+} registry_t;
 
-  const char *p = colon + 1;
-  while (*p && isspace((unsigned char)*p)) p++;
+static registry_t chosen;
+static bool chosen_set;
 
-  if (*p != '"') return NULL;
-  p++;
 
-  const char *end = p;
-  while (*end && *end != '"') {
-    if (*end == '\\' && *(end + 1)) {
-      end += 2;
+/** Probe of one configured registry. */
+typedef struct {
+  bool reachable;
+  double seconds;
+  long long generation;   // Of its index.json, 0 if it has none
+  char *index;            // Its index.json, or NULL
+} probe_t;
+
+
+/** Whether a configured URL names the index.json of a static registry.
+ *  @param url Configured URL
+ *  @return true if it ends in "/index.json"
+ */
+static bool is_static_url(const char *url) {
+  size_t len = strlen(url);
+  size_t suffix = strlen("/index.json");
+  return len > suffix && strcmp(url + len - suffix, "/index.json") == 0;
+}
+
+
+/** Reads a static registry's index.json.
+ *  @param json The index
+ *  @param generation Receives its generation
+ *  @param listing Receives the listing's path below the registry, or
+ *         NULL if not wanted. Caller must free.
+ *  @return true if the index is well formed
+ */
+static bool read_index(const char *json, long long *generation,
+                       char **listing) {
+  jbox_json_reader_t r;
+  jbox_json_reader_init(&r, json, strlen(json));
+
+  *generation = 0;
+  char *path = NULL;
+  if (jbox_json_next(&r) == JBOX_JSON_OBJECT_BEGIN) {
+    while (jbox_json_next(&r) == JBOX_JSON_KEY) {
+      if (strcmp(r.text, "generation") == 0) {
+        jbox_json_read_int(&r, generation);
+      } else if (strcmp(r.text, "listing") == 0) {
+        free(path);
+        path = jbox_json_read_string(&r);
+      } else if (jbox_json_skip(&r, jbox_json_next(&r)) != 0) {
+        break;
+      }
+    }
+  }
+  jbox_json_reader_free(&r);
+
+  // The listing must be a plain path below the registry
+  bool ok = path && path[0] && path[0] != '/' && !strstr(path, "..") &&
+            !strchr(path, ':') && !strchr(path, '?');
+  if (ok && listing) {
+    *listing = path;
+  } else {
+    free(path);
+  }
+  return ok;
+}
+
+
+/** Records the outcome of a probe.
+ *  @param response Response to the probe
+ *  @param ctx Array of probe_t
+ */
+static void probe_done(const jbox_http_response_t *response, void *ctx) {
+  probe_t *probe = &((probe_t *)ctx)[response->index];
+  probe->reachable = response->result == CURLE_OK &&
+                     response->http_code > 0 && response->http_code < 500;
+  probe->seconds = response->seconds;
+  if (response->http_code == 200 && response->body &&
+      read_index(response->body, &probe->generation, NULL)) {
+    probe->index = strdup(response->body);
+  }
+}
+
+
+/** Probes several registries at once and picks one. Mirrors that serve
+ *  an older generation of the static layout than others are passed
+ *  over; of the rest the one that answered fastest wins.
+ *  @param urls Configured URLs
+ *  @param count Number of URLs (at least 2)
+ *  @param index Receives the winner's index.json, or NULL. Caller must
+ *         free.
+ *  @return Index of the chosen URL
+ */
+static int probe_registries(char *const *urls, int count, char **index) {
+  jbox_http_request_t requests[PKG_REGISTRY_MAX_MIRRORS];
+  char *probe_urls[PKG_REGISTRY_MAX_MIRRORS];
+  probe_t probes[PKG_REGISTRY_MAX_MIRRORS] = {0};
+  for (int i = 0; i < count; i++) {
+    // Registry servers serve the static layout too
+    size_t len = strlen(urls[i]) + strlen("/index.json") + 1;
+    probe_urls[i] = malloc(len);
+    if (probe_urls[i]) {
+      snprintf(probe_urls[i], len, "%s%s", urls[i],
+               is_static_url(urls[i]) ? "" : "/index.json");
+    }
+    requests[i] = (jbox_http_request_t){probe_urls[i] ? probe_urls[i]
+                                                      : urls[i], NULL};
+  }
+
+  jbox_http_batch_opts_t opts = {
+    .user_agent = "jbox-pkg/1.0",
+    .max_parallel = count
+  };
+  jbox_http_batch(requests, (size_t)count, &opts, probe_done, probes);
+
+  int best = -1;
+  for (int i = 0; i < count; i++) {
+    if (!probes[i].reachable) continue;
+    if (best < 0 || probes[i].generation > probes[best].generation ||
+        (probes[i].generation == probes[best].generation &&
+         probes[i].seconds < probes[best].seconds)) {
+      best = i;
+    }
+  }
+  if (best < 0) best = 0;
+
+  *index = probes[best].index;
+  probes[best].index = NULL;
+  for (int i = 0; i < count; i++) {
+    free(probes[i].index);
+    free(probe_urls[i]);
+  }
+  return best;
+}
+
+
+/** Picks the registry this process talks to, once.
+ *  @return The registry
+ */
+static registry_t *registry_choose(void) {
+  if (chosen_set) return &chosen;
+  chosen_set = true;
+
+  char *config = strdup(pkg_registry_get_url());
+  char *urls[PKG_REGISTRY_MAX_MIRRORS];
+  int count = 0;
+  char *save = NULL;
+  for (char *url = config ? strtok_r(config, " \t\n,", &save) : NULL;
+       url && count < PKG_REGISTRY_MAX_MIRRORS;
+       url = strtok_r(NULL, " \t\n,", &save)) {
+    urls[count++] = url;
+  }
+  if (count == 0) {
+    free(config);
+    config = strdup(PKG_REGISTRY_DEFAULT_URL);
+    urls[count++] = config;
+  }
+
+  char *index = NULL;
+  int best = count > 1 ? probe_registries(urls, count, &index) : 0;
+
+  const char *url = urls[best] ? urls[best] : PKG_REGISTRY_DEFAULT_URL;
+  size_t len = strlen(url);
+  chosen.is_static = is_static_url(url);
+  if (chosen.is_static) {
+    len -= strlen("/index.json");
+  }
+  while (len > 0 && url[len - 1] == '/') len--;
+  chosen.base = strndup(url, len);
+  chosen.index = chosen.is_static ? index : NULL;
+  if (!chosen.is_static) free(index);
+  free(config);
+  return &chosen;
+}
+
+
+/** Makes a URL in a static registry's listing absolute.
+ *  @param url URL to resolve in place; relative ones are relative to
+ *         the directory of index.json
+ *  @param base The registry's base URL
+ */
+static void resolve_url(char **url, const char *base) {
+  if (!*url || strstr(*url, "://") || (*url)[0] == '/') return;
+  size_t len = strlen(base) + strlen(*url) + 2;
+  char *absolute = malloc(len);
+  if (!absolute) return;
+  snprintf(absolute, len, "%s/%s", base, *url);
+  free(*url);
+  *url = absolute;
+}
+
+
+/** Makes the download URLs of an entry absolute.
+ *  @param entry Registry entry
+ *  @param base The registry's base URL
+ */
+static void resolve_entry(PkgRegistryEntry *entry, const char *base) {
+  resolve_url(&entry->download_url, base);
+  resolve_url(&entry->binary_url, base);
+  for (int i = 0; i < entry->delta_count; i++) {
+    resolve_url(&entry->deltas[i].url, base);
+  }
+}
+
+
+/** Fetches a static registry's listing. index.json is fetched each time
+ *  (or taken from choosing the registry); the listing it names is named
+ *  by its digest, so a cached copy of it is current without asking.
+ *  @param reg Static registry
+ *  @return Allocated listing, or NULL on error. Caller must free.
+ */
+static char *fetch_static_listing(registry_t *reg) {
+  char url[1024];
+  char *index = reg->index;
+  reg->index = NULL;
+  if (!index) {
+    snprintf(url, sizeof(url), "%s/index.json", reg->base);
+    index = fetch_json(url, NULL, NULL, NULL, NULL);
+  }
+  if (!index) return NULL;
+
+  long long generation;
+  char *listing = NULL;
+  bool ok = read_index(index, &generation, &listing);
+  free(index);
+  if (!ok) return NULL;
+  snprintf(url, sizeof(url), "%s/%s", reg->base, listing);
+  free(listing);
+
+  validators_t cached = {0};
+  char *json = listing_cache_load(url, &cached);
+  validators_free(&cached);
+  if (json) return json;
+
+  validators_t got = {0};
+  json = fetch_json(url, NULL, NULL, &got, NULL);
+  if (json && (got.etag || got.last_modified)) {
+    listing_cache_store(url, &got, json);
+  }
+  validators_free(&got);
+  return json;
+}
+
+
+/** Reads a package's tags as one space-separated string.
+ *  @param r Reader positioned before the array
+ *  @return Allocated string, or NULL if there are no tags. Caller must
+ *          free.
+ */
+static char *read_tags(jbox_json_reader_t *r) {
+  int count = 0;
+  char **tags = jbox_json_read_string_array(r, &count);
+
+  size_t len = 0;
+  for (int i = 0; i < count; i++) {
+    len += strlen(tags[i]) + 1;
+  }
+  char *joined = len > 0 ? malloc(len) : NULL;
+  if (joined) {
+    char *p = joined;
+    for (int i = 0; i < count; i++) {
+      if (i > 0) *p++ = ' ';
+      size_t n = strlen(tags[i]);
+      memcpy(p, tags[i], n);
+      p += n;
+    }
+    *p = '\0';
+  }
+
+  for (int i = 0; i < count; i++) free(tags[i]);
+  free(tags);
+  return joined;
+}
+
+
+/** Reads a package's prebuilt tarballs, keeping the one for this
+ *  machine's platform.
+ *  Each is an object {"platform", "downloadUrl", "sha256"}.
+ *  @param r Reader positioned before the array
+ *  @param entry Entry receiving binary_url and binary_sha256
+ *  @return 0 on success, -1 on malformed input
+ */
+static int read_binaries(jbox_json_reader_t *r, PkgRegistryEntry *entry) {
+  char platform[128];
+  bool have_platform = pkg_platform(platform, sizeof(platform)) == 0;
+
+  jbox_json_event_t ev = jbox_json_next(r);
+  if (ev != JBOX_JSON_ARRAY_BEGIN) {
+    return jbox_json_skip(r, ev);
+  }
+
+  while ((ev = jbox_json_next(r)) != JBOX_JSON_ARRAY_END) {
+    if (ev != JBOX_JSON_OBJECT_BEGIN) {
+      if (jbox_json_skip(r, ev) != 0) return -1;
+      continue;
+    }
+
+    char *tag = NULL;
+    char *url = NULL;
+    char *sha256 = NULL;
+    while ((ev = jbox_json_next(r)) == JBOX_JSON_KEY) {
+      char **field = NULL;
+      if (strcmp(r->text, "platform") == 0) {
+        field = &tag;
+      } else if (strcmp(r->text, "downloadUrl") == 0) {
+        field = &url;
+      } else if (strcmp(r->text, "sha256") == 0) {
+        field = &sha256;
+      }
+
+      if (field) {
+        free(*field);
+        *field = jbox_json_read_string(r);
+      } else if (jbox_json_skip(r, jbox_json_next(r)) != 0) {
+        break;
+      }
+    }
+
+    // The first match wins
+    bool match = ev == JBOX_JSON_OBJECT_END && have_platform && tag && url
+                 && !entry->binary_url && strcmp(tag, platform) == 0;
+    if (match) {
+      entry->binary_url = url;
+      entry->binary_sha256 = sha256;
     } else {
-      end++;
+      free(url);
+      free(sha256);
     }
+    free(tag);
+    if (ev != JBOX_JSON_OBJECT_END) return -1;
   }
 
-  size_t len = (size_t)(end - p);
-  char *result = malloc(len + 1);
-  if (!result) return NULL;
-
-  // Copy with basic escape handling
-  size_t j = 0;
-  for (size_t i = 0; i < len; i++) {
-    if (p[i] == '\\' && i + 1 < len) {
-      switch (p[i + 1]) {
-        case 'n': result[j++] = '\n'; i++; break;
-        case 't': result[j++] = '\t'; i++; break;
-        case 'r': result[j++] = '\r'; i++; break;
-        case '"': result[j++] = '"'; i++; break;
-        case '\\': result[j++] = '\\'; i++; break;
-        default: result[j++] = p[i]; break;
+  return 0;
+}
+
+
+/** Reads a package's "deltas" array, keeping the deltas between source
+ *  tarballs and between prebuilt packages for this machine's platform.
+ *  Each is an object {"from", "platform", "downloadUrl", "sha256"},
+ *  without "platform" for deltas between source tarballs.
+ *  @param r Reader positioned before the array
+ *  @param entry Entry receiving deltas and delta_count
+ *  @return 0 on success, -1 on malformed input
+ */
+static int read_deltas(jbox_json_reader_t *r, PkgRegistryEntry *entry) {
+  char platform[128];
+  bool have_platform = pkg_platform(platform, sizeof(platform)) == 0;
+
+  jbox_json_event_t ev = jbox_json_next(r);
+  if (ev != JBOX_JSON_ARRAY_BEGIN) {
+    return jbox_json_skip(r, ev);
+  }
+
+  while ((ev = jbox_json_next(r)) != JBOX_JSON_ARRAY_END) {
+    if (ev != JBOX_JSON_OBJECT_BEGIN) {
+      if (jbox_json_skip(r, ev) != 0) return -1;
+      continue;
+    }
+
+    char *tag = NULL;
+    PkgRegistryDelta delta = {0};
+    while ((ev = jbox_json_next(r)) == JBOX_JSON_KEY) {
+      char **field = NULL;
+      if (strcmp(r->text, "from") == 0) {
+        field = &delta.from;
+      } else if (strcmp(r->text, "platform") == 0) {
+        field = &tag;
+      } else if (strcmp(r->text, "downloadUrl") == 0) {
+        field = &delta.url;
+      } else if (strcmp(r->text, "sha256") == 0) {
+        field = &delta.sha256;
       }
+
+      if (field) {
+        free(*field);
+        *field = jbox_json_read_string(r);
+      } else if (jbox_json_skip(r, jbox_json_next(r)) != 0) {
+        break;
+      }
+    }
+
+    delta.binary = tag != NULL;
+    bool keep = ev == JBOX_JSON_OBJECT_END && delta.from && delta.url &&
+                (!tag || (have_platform && strcmp(tag, platform) == 0));
+    PkgRegistryDelta *grown = keep
+      ? realloc(entry->deltas,
+                (size_t)(entry->delta_count + 1) * sizeof(PkgRegistryDelta))
+      : NULL;
+    if (grown) {
+      entry->deltas = grown;
+      entry->deltas[entry->delta_count++] = delta;
     } else {
-      result[j++] = p[i];
+      free(delta.from);
+      free(delta.url);
+      free(delta.sha256);
     }
+    free(tag);
+    if (ev != JBOX_JSON_OBJECT_END) return -1;
   }
-  result[j] = '\0';
 
-  return result;
+  return 0;
 }
 
 
-/** Parses a package registry entry from JSON object.
- *  @param json JSON string containing package object
- *  @return Allocated PkgRegistryEntry, or NULL on error. Caller must free with pkg_registry_entry_free.
+/** Parses the members of a registry package object.
+ *  @param r Reader positioned just inside the object
+ *  @return Allocated PkgRegistryEntry, or NULL if malformed or unnamed.
+ *          Caller must free with pkg_registry_entry_free.
  */
-static PkgRegistryEntry *parse_package_object(const char *json) {
+static PkgRegistryEntry *parse_package_object(jbox_json_reader_t *r) {
   PkgRegistryEntry *entry = calloc(1, sizeof(PkgRegistryEntry));
   if (!entry) return NULL;
 
-  entry->name = json_get_string(json, "name");
-  entry->latest_version = json_get_string(json, "latestVersion");
-  entry->description = json_get_string(json, "description");
-  entry->download_url = json_get_string(json, "downloadUrl");
+  jbox_json_event_t ev;
+  while ((ev = jbox_json_next(r)) == JBOX_JSON_KEY) {
+    char **field = NULL;
+    if (strcmp(r->text, "name") == 0) {
+      field = &entry->name;
+    } else if (strcmp(r->text, "latestVersion") == 0) {
+      field = &entry->latest_version;
+    } else if (strcmp(r->text, "description") == 0) {
+      field = &entry->description;
+    } else if (strcmp(r->text, "downloadUrl") == 0) {
+      field = &entry->download_url;
+    } else if (strcmp(r->text, "sha256") == 0) {
+      field = &entry->sha256;
+    } else if (strcmp(r->text, "tags") == 0) {
+      free(entry->tags);
+      entry->tags = read_tags(r);
+      continue;
+    } else if (strcmp(r->text, "binaries") == 0) {
+      if (read_binaries(r, entry) != 0) break;
+      continue;
+    } else if (strcmp(r->text, "deltas") == 0) {
+      if (read_deltas(r, entry) != 0) break;
+      continue;
+    }
 
-  if (!entry->name) {
+    if (field) {
+      free(*field);
+      *field = jbox_json_read_string(r);
+    } else if (jbox_json_skip(r, jbox_json_next(r)) != 0) {
+      break;
+    }
+  }
+
+  if (ev != JBOX_JSON_OBJECT_END || !entry->name) {
     pkg_registry_entry_free(entry);
     return NULL;
   }
@@ -202,104 +815,158 @@ static PkgRegistryEntry *parse_package_object(const char *json) {
 }
 
 
-/** Fetches all available packages from the registry.
- *  @return Allocated PkgRegistryList, or NULL on error. Caller must free with pkg_registry_list_free.
+/** Appends an entry to a registry list, taking ownership of its fields.
+ *  @param list List to append to
+ *  @param entry Entry whose container is freed on success
+ *  @return 0 on success, -1 on allocation failure
  */
-PkgRegistryList *pkg_registry_fetch_all(void) {
-  const char *base_url = pkg_registry_get_url();
-  char url[512];
-  snprintf(url, sizeof(url), "%s/packages", base_url);
+static int list_append(PkgRegistryList *list, PkgRegistryEntry *entry) {
+  if (list->count >= list->capacity) {
+    int new_cap = list->capacity == 0 ? 16 : list->capacity * 2;
+    PkgRegistryEntry *new_entries = realloc(list->entries,
+      (size_t)new_cap * sizeof(PkgRegistryEntry));
+    if (!new_entries) return -1;
+    list->entries = new_entries;
+    list->capacity = new_cap;
+  }
+  list->entries[list->count++] = *entry;
+  free(entry);
+  return 0;
+}
 
-  char *json = fetch_json(url);
-  if (!json) return NULL;
 
-  // Check for status: ok
-  char *status = json_get_string(json, "status");
-  if (!status || strcmp(status, "ok") != 0) {
-    free(status);
-    free(json);
-    return NULL;
+/** Parses an array of registry package objects into a list.
+ *  @param r Reader positioned before the array
+ *  @param list List receiving the packages
+ *  @return 0 on success, -1 on malformed input
+ */
+static int parse_package_array(jbox_json_reader_t *r, PkgRegistryList *list) {
+  jbox_json_event_t ev = jbox_json_next(r);
+  if (ev != JBOX_JSON_ARRAY_BEGIN) {
+    jbox_json_skip(r, ev);
+    return -1;
   }
+
+  while ((ev = jbox_json_next(r)) != JBOX_JSON_ARRAY_END) {
+    if (ev != JBOX_JSON_OBJECT_BEGIN) {
+      if (jbox_json_skip(r, ev) != 0) return -1;
+      continue;
+    }
+
+    PkgRegistryEntry *entry = parse_package_object(r);
+    if (entry && list_append(list, entry) != 0) {
+      pkg_registry_entry_free(entry);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+
+/** Checks a registry response's "status" member.
+ *  @param r Reader positioned before the value
+ *  @return true if the status is "ok"
+ */
+static bool read_status_ok(jbox_json_reader_t *r) {
+  char *status = jbox_json_read_string(r);
+  bool ok = status && strcmp(status, "ok") == 0;
   free(status);
+  return ok;
+}
 
-  PkgRegistryList *list = calloc(1, sizeof(PkgRegistryList));
-  if (!list) {
-    free(json);
-    return NULL;
+
+/** Hashes a listing, to tell whether it changed (64-bit FNV-1a).
+ *  @param s Listing
+ *  @return Hash
+ */
+static uint64_t listing_hash(const char *s) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (; *s; s++) {
+    hash ^= (unsigned char)*s;
+    hash *= 1099511628211ULL;
   }
+  return hash;
+}
 
-  // Find packages array
-  const char *packages_start = strstr(json, "\"packages\"");
-  if (!packages_start) {
-    free(json);
-    free(list);
-    return NULL;
+
+/** Brings the search index in line with a listing just fetched.
+ *  An index of the same listing is only marked as checked; otherwise it
+ *  is rebuilt. Failing to write it only makes searches slower.
+ *  @param registry Registry URL
+ *  @param list Listing
+ *  @param hash Hash of the listing
+ */
+static void refresh_search_index(const char *registry,
+                                 const PkgRegistryList *list, uint64_t hash) {
+  PkgSearchIndex idx;
+  if (pkg_search_index_open(&idx, registry) == 0) {
+    bool same = idx.header->listing_hash == hash;
+    pkg_search_index_close(&idx);
+    if (same) {
+      pkg_search_index_touch();
+      return;
+    }
+  }
+
+  if (pkg_search_index_build(&idx, registry, list, hash) == 0) {
+    pkg_search_index_save(&idx);
+    pkg_search_index_close(&idx);
   }
+}
+
 
-  const char *arr_start = strchr(packages_start, '[');
-  if (!arr_start) {
+/** Fetches all available packages from the registry.
+ *  @return Allocated PkgRegistryList, or NULL on error. Caller must free with pkg_registry_list_free.
+ */
+PkgRegistryList *pkg_registry_fetch_all(void) {
+  registry_t *reg = registry_choose();
+  char *json;
+  if (reg->is_static) {
+    json = fetch_static_listing(reg);
+  } else {
+    char url[1024];
+    snprintf(url, sizeof(url), "%s/packages", reg->base);
+    json = fetch_listing(url);
+  }
+  if (!json) return NULL;
+
+  PkgRegistryList *list = calloc(1, sizeof(PkgRegistryList));
+  if (!list) {
     free(json);
-    free(list);
     return NULL;
   }
 
-  // Parse each object in the array
-  const char *p = arr_start + 1;
-  while (*p) {
-    while (*p && isspace((unsigned char)*p)) p++;
-
-    if (*p == ']') break;
-    if (*p == ',') { p++; continue; }
-
-    if (*p == '{') {
-      // Find matching closing brace
-      int depth = 1;
-      const char *obj_start = p;
-      p++;
-      while (*p && depth > 0) {
-        if (*p == '{') depth++;
-        else if (*p == '}') depth--;
-        else if (*p == '"') {
-          p++;
-          while (*p && *p != '"') {
-            if (*p == '\\' && *(p + 1)) p++;
-            p++;
-          }
-        }
-        if (*p) p++;
-      }
-
-      size_t obj_len = (size_t)(p - obj_start);
-      char *obj_json = malloc(obj_len + 1);
-      if (obj_json) {
-        memcpy(obj_json, obj_start, obj_len);
-        obj_json[obj_len] = '\0';
-
-        PkgRegistryEntry *entry = parse_package_object(obj_json);
-        free(obj_json);
-
-        if (entry) {
-          if (list->count >= list->capacity) {
-            int new_cap = list->capacity == 0 ? 16 : list->capacity * 2;
-            PkgRegistryEntry *new_entries = realloc(list->entries,
-              (size_t)new_cap * sizeof(PkgRegistryEntry));
-            if (!new_entries) {
-              pkg_registry_entry_free(entry);
-              break;
-            }
-            list->entries = new_entries;
-            list->capacity = new_cap;
-          }
-          list->entries[list->count++] = *entry;
-          free(entry);
-        }
+  jbox_json_reader_t r;
+  jbox_json_reader_init(&r, json, strlen(json));
+
+  // Expect {"status": "ok", "packages": [...]}, members in any order
+  bool status_ok = false;
+  bool have_packages = false;
+  if (jbox_json_next(&r) == JBOX_JSON_OBJECT_BEGIN) {
+    while (jbox_json_next(&r) == JBOX_JSON_KEY) {
+      if (strcmp(r.text, "status") == 0) {
+        status_ok = read_status_ok(&r);
+      } else if (strcmp(r.text, "packages") == 0) {
+        have_packages = parse_package_array(&r, list) == 0;
+      } else if (jbox_json_skip(&r, jbox_json_next(&r)) != 0) {
+        break;
       }
-    } else {
-      p++;
     }
   }
 
+  jbox_json_reader_free(&r);
+  uint64_t hash = listing_hash(json);
   free(json);
+
+  if (!status_ok || !have_packages) {
+    pkg_registry_list_free(list);
+    return NULL;
+  }
+  for (int i = 0; reg->is_static && i < list->count; i++) {
+    resolve_entry(&list->entries[i], reg->base);
+  }
+  refresh_search_index(pkg_registry_get_url(), list, hash);
   return list;
 }
 
@@ -311,167 +978,218 @@ PkgRegistryList *pkg_registry_fetch_all(void) {
 PkgRegistryEntry *pkg_registry_fetch_package(const char *name) {
   if (!name) return NULL;
 
-  const char *base_url = pkg_registry_get_url();
-  char url[512];
-  snprintf(url, sizeof(url), "%s/packages/%s", base_url, name);
+  registry_t *reg = registry_choose();
+  char url[1024];
+  if (reg->is_static) {
+    // Package files are spread over directories by the first byte of
+    // the name's digest
+    if (strchr(name, '/') || strstr(name, "..")) return NULL;
+    jbox_sha256_t md;
+    jbox_sha256_init(&md);
+    jbox_sha256_update(&md, name, strlen(name));
+    uint8_t digest[JBOX_SHA256_LEN];
+    jbox_sha256_final(&md, digest);
+    char shard[3];
+    jbox_hash_hex(digest, 1, shard);
+    snprintf(url, sizeof(url), "%s/packages/%s/%s.json", reg->base, shard,
+             name);
+  } else {
+    snprintf(url, sizeof(url), "%s/packages/%s", reg->base, name);
+  }
 
-  char *json = fetch_json(url);
+  char *json = fetch_json(url, NULL, NULL, NULL, NULL);
   if (!json) return NULL;
 
-  // Check for status: ok
-  char *status = json_get_string(json, "status");
-  if (!status || strcmp(status, "ok") != 0) {
-    free(status);
-    free(json);
-    return NULL;
+  jbox_json_reader_t r;
+  jbox_json_reader_init(&r, json, strlen(json));
+
+  // Expect {"status": "ok", "package": {...}}, members in any order
+  bool status_ok = false;
+  PkgRegistryEntry *entry = NULL;
+  if (jbox_json_next(&r) == JBOX_JSON_OBJECT_BEGIN) {
+    while (jbox_json_next(&r) == JBOX_JSON_KEY) {
+      if (strcmp(r.text, "status") == 0) {
+        status_ok = read_status_ok(&r);
+      } else if (strcmp(r.text, "package") == 0) {
+        jbox_json_event_t ev = jbox_json_next(&r);
+        if (ev == JBOX_JSON_OBJECT_BEGIN) {
+          pkg_registry_entry_free(entry);
+          entry = parse_package_object(&r);
+        } else if (jbox_json_skip(&r, ev) != 0) {
+          break;
+        }
+      } else if (jbox_json_skip(&r, jbox_json_next(&r)) != 0) {
+        break;
+      }
+    }
   }
-  free(status);
 
-  // Find package object
-  const char *pkg_start = strstr(json, "\"package\"");
-  if (!pkg_start) {
-    free(json);
-    return NULL;
-  }
+  jbox_json_reader_free(&r);
+  free(json);
 
-  const char *obj_start = strchr(pkg_start, '{');
-  if (!obj_start) {
-    free(json);
+  if (!status_ok) {
+    pkg_registry_entry_free(entry);
     return NULL;
   }
-
-  PkgRegistryEntry *entry = parse_package_object(obj_start);
-  free(json);
-
+  if (entry && reg->is_static) {
+    resolve_entry(entry, reg->base);
+  }
   return entry;
 }
 
 
-/** Searches the registry for packages matching a query.
- *  @param query Search query string
- *  @return Allocated PkgRegistryList with matching packages, or NULL on error. Caller must free with pkg_registry_list_free.
+/** Fetches the latest versions of several packages in one request.
+ *  @param names Package names
+ *  @param count Number of names
+ *  @return Allocated PkgRegistryList of the packages the registry has,
+ *          with name and latest_version set, or NULL on error (including
+ *          a registry without POST /packages/versions). Caller must free
+ *          with pkg_registry_list_free.
  */
-PkgRegistryList *pkg_registry_search(const char *query) {
-  if (!query) return NULL;
-
-  // Fetch all packages and filter by query
-  PkgRegistryList *all = pkg_registry_fetch_all();
-  if (!all) return NULL;
-
-  PkgRegistryList *results = calloc(1, sizeof(PkgRegistryList));
-  if (!results) {
-    pkg_registry_list_free(all);
+PkgRegistryList *pkg_registry_fetch_versions(const char *const *names,
+                                             int count) {
+  // Static registries have no such endpoint
+  registry_t *reg = registry_choose();
+  if (reg->is_static) return NULL;
+
+  char *body = NULL;
+  size_t body_size = 0;
+  FILE *out = open_memstream(&body, &body_size);
+  if (!out) return NULL;
+
+  jbox_json_writer_t w;
+  jbox_json_writer_init(&w, out, false);
+  jbox_json_begin_object(&w);
+  jbox_json_key(&w, "names");
+  jbox_json_begin_array(&w);
+  for (int i = 0; i < count; i++) {
+    jbox_json_string(&w, names[i]);
+  }
+  jbox_json_end_array(&w);
+  jbox_json_end_object(&w);
+  if (fclose(out) != 0) {
+    free(body);
     return NULL;
   }
 
-  // Convert query to lowercase for case-insensitive search
-  size_t query_len = strlen(query);
-  char *query_lower = malloc(query_len + 1);
-  if (!query_lower) {
-    free(results);
-    pkg_registry_list_free(all);
+  char url[1024];
+  snprintf(url, sizeof(url), "%s/packages/versions", reg->base);
+  char *json = fetch_json(url, body, NULL, NULL, NULL);
+  free(body);
+  if (!json) return NULL;
+
+  PkgRegistryList *list = calloc(1, sizeof(PkgRegistryList));
+  if (!list) {
+    free(json);
     return NULL;
   }
-  for (size_t i = 0; i <= query_len; i++) {
-    query_lower[i] = (char)tolower((unsigned char)query[i]);
-  }
 
-  for (int i = 0; i < all->count; i++) {
-    PkgRegistryEntry *entry = &all->entries[i];
-    bool match = false;
-
-    // Check name
-    if (entry->name) {
-      char *name_lower = strdup(entry->name);
-      if (name_lower) {
-        for (char *p = name_lower; *p; p++) {
-          *p = (char)tolower((unsigned char)*p);
-        }
-        if (strstr(name_lower, query_lower)) {
-          match = true;
-        }
-        free(name_lower);
+  jbox_json_reader_t r;
+  jbox_json_reader_init(&r, json, strlen(json));
+
+  // Expect {"status": "ok", "packages": [...], "missing": [...]}
+  bool status_ok = false;
+  bool have_packages = false;
+  if (jbox_json_next(&r) == JBOX_JSON_OBJECT_BEGIN) {
+    while (jbox_json_next(&r) == JBOX_JSON_KEY) {
+      if (strcmp(r.text, "status") == 0) {
+        status_ok = read_status_ok(&r);
+      } else if (strcmp(r.text, "packages") == 0) {
+        have_packages = parse_package_array(&r, list) == 0;
+      } else if (jbox_json_skip(&r, jbox_json_next(&r)) != 0) {
+        break;
       }
     }
+  }
 
-    // Check description
-    if (!match && entry->description) {
-      char *desc_lower = strdup(entry->description);
-      if (desc_lower) {
-        for (char *p = desc_lower; *p; p++) {
-          *p = (char)tolower((unsigned char)*p);
-        }
-        if (strstr(desc_lower, query_lower)) {
-          match = true;
-        }
-        free(desc_lower);
-      }
-    }
+  jbox_json_reader_free(&r);
+  free(json);
 
-    if (match) {
-      if (results->count >= results->capacity) {
-        int new_cap = results->capacity == 0 ? 16 : results->capacity * 2;
-        PkgRegistryEntry *new_entries = realloc(results->entries,
-          (size_t)new_cap * sizeof(PkgRegistryEntry));
-        if (!new_entries) break;
-        results->entries = new_entries;
-        results->capacity = new_cap;
-      }
+  if (!status_ok || !have_packages) {
+    pkg_registry_list_free(list);
+    return NULL;
+  }
+  return list;
+}
+
+
+/** Searches the registry for packages matching a query.
+ *  Answered from the local search index while it is recent; otherwise
+ *  the listing is revalidated first, which rebuilds the index if it
+ *  changed. If the registry cannot be reached, an older index still
+ *  answers.
+ *  @param query Search query string
+ *  @return Allocated PkgRegistryList with matching packages, best first,
+ *          or NULL on error. Caller must free with pkg_registry_list_free.
+ */
+PkgRegistryList *pkg_registry_search(const char *query) {
+  if (!query) return NULL;
 
-      // Copy the entry
-      PkgRegistryEntry *dest = &results->entries[results->count];
-      dest->name = entry->name ? strdup(entry->name) : NULL;
-      dest->latest_version = entry->latest_version ?
-                             strdup(entry->latest_version) : NULL;
-      dest->description = entry->description ? strdup(entry->description) : NULL;
-      dest->download_url = entry->download_url ?
-                           strdup(entry->download_url) : NULL;
-      results->count++;
+  const char *registry = pkg_registry_get_url();
+  PkgSearchIndex idx;
+  bool have_index = pkg_search_index_open(&idx, registry) == 0;
+
+  if (!have_index || !pkg_search_index_fresh(&idx, PKG_SEARCH_MAX_AGE)) {
+    PkgRegistryList *all = pkg_registry_fetch_all();
+    if (all) {
+      pkg_search_index_close(&idx);
+      // Index the listing in memory if the cache is not writable
+      have_index = pkg_search_index_open(&idx, registry) == 0
+                   || pkg_search_index_build(&idx, registry, all, 0) == 0;
+      pkg_registry_list_free(all);
     }
   }
+  if (!have_index) return NULL;
 
-  free(query_lower);
-  pkg_registry_list_free(all);
-
+  PkgRegistryList *results = pkg_search_index_query(&idx, query);
+  pkg_search_index_close(&idx);
   return results;
 }
 
 
-/** Downloads a file from a URL to a local path.
+/** Sets up a pooled handle to download a URL into a sink.
  *  @param url URL to download from
- *  @param dest_path Destination file path
- *  @return 0 on success, -1 on error
+ *  @param target Sink to hand the body to
+ *  @return CURL handle to give back with jbox_http_release, or NULL on error
  */
-int pkg_registry_download(const char *url, const char *dest_path) {
-  if (!url || !dest_path) return -1;
-
-  FILE *fp = fopen(dest_path, "wb");
-  if (!fp) return -1;
-
-  CURL *curl = curl_easy_init();
-  if (!curl) {
-    fclose(fp);
-    return -1;
-  }
+static CURL *download_handle(const char *url, sink_target_t *target) {
+  CURL *curl = jbox_http_acquire();
+  if (!curl) return NULL;
 
   curl_easy_setopt(curl, CURLOPT_URL, url);
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, file_write_callback);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, sink_write_callback);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, target);
   curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
   curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 5L);
   curl_easy_setopt(curl, CURLOPT_TIMEOUT, 300L);
   curl_easy_setopt(curl, CURLOPT_USERAGENT, "jbox-pkg/1.0");
+  // An error status must not feed its error page to the sink
+  curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+  return curl;
+}
+
+
+/** Downloads a URL, handing its body to a sink as it arrives.
+ *  @param url URL to download from
+ *  @param sink Receives the body
+ *  @param ctx Passed to sink
+ *  @return 0 on success, -1 on error
+ */
+int pkg_registry_download(const char *url, PkgDownloadSink sink, void *ctx) {
+  if (!url || !sink) return -1;
+
+  sink_target_t target = { .sink = sink, .ctx = ctx };
+  CURL *curl = download_handle(url, &target);
+  if (!curl) return -1;
 
   CURLcode res = curl_easy_perform(curl);
 
   long http_code = 0;
   curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
 
-  curl_easy_cleanup(curl);
-  fclose(fp);
+  jbox_http_release(curl);
 
   if (res != CURLE_OK || http_code >= 400) {
-    remove(dest_path);
     return -1;
   }
 
@@ -479,6 +1197,209 @@ int pkg_registry_download(const char *url, const char *dest_path) {
 }
 
 
+/** Downloads a URL as parallel byte ranges, then hands its body to a sink.
+ *  @param url URL to download from
+ *  @param segments Most ranges to fetch at once
+ *  @param sink Receives the body, in order
+ *  @param ctx Passed to sink
+ *  @return 0 on success, -1 on error
+ */
+int pkg_registry_download_segmented(const char *url, int segments,
+                                    PkgDownloadSink sink, void *ctx) {
+  if (!url || !sink) return -1;
+  if (segments < 2) return pkg_registry_download(url, sink, ctx);
+
+  // The ranges arrive out of order, so the sink reads them back from a
+  // spool file once the whole tarball is there
+  FILE *spool = tmpfile();
+  if (!spool) return -1;
+
+  jbox_http_segment_opts_t opts = {
+    .user_agent = "jbox-pkg/1.0",
+    .timeout = 300L
+  };
+  int rc = jbox_http_download_segments(url, fileno(spool), segments, &opts,
+                                       NULL);
+  if (rc == JBOX_HTTP_NO_RANGES) {
+    fclose(spool);
+    return pkg_registry_download(url, sink, ctx);
+  }
+
+  char block[65536];
+  size_t n;
+  while (rc == 0 && (n = fread(block, 1, sizeof(block), spool)) > 0) {
+    if (sink(block, n, ctx) != 0) rc = -1;
+  }
+  if (ferror(spool)) rc = -1;
+  fclose(spool);
+  return rc == 0 ? 0 : -1;
+}
+
+
+/** One download of pkg_registry_download_all in flight. */
+typedef struct {
+  int index;
+  sink_target_t target;
+} transfer_t;
+
+
+/** Starts a download on a multi handle.
+ *  @param multi Multi handle
+ *  @param download Download to start
+ *  @param t Transfer state to fill in
+ *  @return 0 on success, -1 on error
+ */
+static int start_transfer(CURLM *multi, const PkgDownload *download,
+                          transfer_t *t) {
+  if (!download->url || !download->sink) return -1;
+
+  t->target.sink = download->sink;
+  t->target.ctx = download->ctx;
+  CURL *curl = download_handle(download->url, &t->target);
+  if (!curl) return -1;
+
+  // Several downloads from one registry share a connection where they can
+  curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+  curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+  curl_easy_setopt(curl, CURLOPT_PRIVATE, t);
+
+  if (curl_multi_add_handle(multi, curl) != CURLM_OK) {
+    jbox_http_release(curl);
+    return -1;
+  }
+  return 0;
+}
+
+
+/** Downloads several files at once.
+ *  @param downloads Files to download
+ *  @param count Number of downloads
+ *  @param max_parallel Most downloads in flight at once
+ *  @param done Called as each download finishes, or NULL
+ *  @param ctx Passed to done
+ *  @return 0 if every download succeeded, -1 otherwise
+ */
+int pkg_registry_download_all(const PkgDownload *downloads, int count,
+                              int max_parallel, PkgDownloadDone done,
+                              void *ctx) {
+  if (count <= 0) return 0;
+  if (!downloads || max_parallel < 1) return -1;
+
+  CURLM *multi = curl_multi_init();
+  transfer_t *transfers = calloc((size_t)count, sizeof(transfer_t));
+  if (!multi || !transfers) {
+    curl_multi_cleanup(multi);
+    free(transfers);
+    return -1;
+  }
+  curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+  curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long)max_parallel);
+
+  int next = 0;
+  int active = 0;
+  int result = 0;
+  while (next < count || active > 0) {
+    // Keep max_parallel downloads going
+    while (next < count && active < max_parallel) {
+      transfer_t *t = &transfers[next];
+      t->index = next;
+      if (start_transfer(multi, &downloads[next], t) == 0) {
+        active++;
+      } else {
+        result = -1;
+        if (done) done(next, -1, ctx);
+      }
+      next++;
+    }
+    if (active == 0) continue;
+
+    int running = 0;
+    curl_multi_perform(multi, &running);
+
+    CURLMsg *msg;
+    int queued;
+    while ((msg = curl_multi_info_read(multi, &queued)) != NULL) {
+      if (msg->msg != CURLMSG_DONE) continue;
+
+      CURL *curl = msg->easy_handle;
+      transfer_t *t = NULL;
+      long http_code = 0;
+      curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&t);
+      curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+      int ok = msg->data.result == CURLE_OK && http_code < 400;
+
+      curl_multi_remove_handle(multi, curl);
+      jbox_http_release(curl);
+      active--;
+
+      if (!ok) result = -1;
+      if (done) done(t->index, ok ? 0 : -1, ctx);
+    }
+
+    if (active > 0) {
+      curl_multi_poll(multi, NULL, 0, 1000, NULL);
+    }
+  }
+
+  curl_multi_cleanup(multi);
+  free(transfers);
+  return result;
+}
+
+
+/** Picks the tarball to install for a registry entry.
+ *  @param entry Registry entry
+ *  @return The prebuilt tarball's URL if there is one for this platform,
+ *          else the source tarball's (may be NULL)
+ */
+const char *pkg_registry_entry_url(const PkgRegistryEntry *entry) {
+  return entry->binary_url ? entry->binary_url : entry->download_url;
+}
+
+
+/** Gives the digest of the tarball pkg_registry_entry_url picks.
+ *  @param entry Registry entry
+ *  @return Hex digest, or NULL if the registry does not list one
+ */
+const char *pkg_registry_entry_sha256(const PkgRegistryEntry *entry) {
+  return entry->binary_url ? entry->binary_sha256 : entry->sha256;
+}
+
+
+/** Finds the delta that upgrades an installed version of a package.
+ *  @param entry Registry entry
+ *  @param from Installed version
+ *  @param binary Whether the installed version is this platform's
+ *         prebuilt package
+ *  @return Delta to the tarball pkg_registry_entry_url picks, or NULL
+ */
+const PkgRegistryDelta *pkg_registry_entry_delta(const PkgRegistryEntry *entry,
+                                                 const char *from,
+                                                 bool binary) {
+  if (binary != (entry->binary_url != NULL)) return NULL;
+  for (int i = 0; i < entry->delta_count; i++) {
+    const PkgRegistryDelta *delta = &entry->deltas[i];
+    if (delta->binary == binary && strcmp(delta->from, from) == 0) {
+      return delta;
+    }
+  }
+  return NULL;
+}
+
+
+/** Frees the deltas of a registry entry.
+ *  @param entry Entry whose deltas to free
+ */
+static void free_deltas(PkgRegistryEntry *entry) {
+  for (int i = 0; i < entry->delta_count; i++) {
+    free(entry->deltas[i].from);
+    free(entry->deltas[i].url);
+    free(entry->deltas[i].sha256);
+  }
+  free(entry->deltas);
+}
+
+
 /** Frees a package registry entry.
  *  @param entry Pointer to entry to free
  */
@@ -488,6 +1409,11 @@ void pkg_registry_entry_free(PkgRegistryEntry *entry) {
   free(entry->latest_version);
   free(entry->description);
   free(entry->download_url);
+  free(entry->sha256);
+  free(entry->tags);
+  free(entry->binary_url);
+  free(entry->binary_sha256);
+  free_deltas(entry);
   free(entry);
 }
 
@@ -502,6 +1428,11 @@ void pkg_registry_list_free(PkgRegistryList *list) {
     free(list->entries[i].latest_version);
     free(list->entries[i].description);
     free(list->entries[i].download_url);
+    free(list->entries[i].sha256);
+    free(list->entries[i].tags);
+    free(list->entries[i].binary_url);
+    free(list->entries[i].binary_sha256);
+    free_deltas(&list->entries[i]);
   }
   free(list->entries);
   free(list);
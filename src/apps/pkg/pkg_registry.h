@@ -2,16 +2,40 @@
 #define PKG_REGISTRY_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 // Default registry URL (can be overridden by JSHELL_PKG_REGISTRY env var)
 #define PKG_REGISTRY_DEFAULT_URL "http://localhost:3000"
 
+// JSHELL_PKG_REGISTRY may name several registries, separated by spaces
+// or commas; each is a registry server, or a static copy of one (as
+// written by generate-pkg-manifest.sh) named by its index.json. When
+// there are several, all are asked for their index.json at once and
+// the fastest of those with the newest generation is used.
+#define PKG_REGISTRY_MAX_MIRRORS 8
+
+// Delta from an older version to an entry's latest (see pkg_delta.h)
+typedef struct {
+  char *from;             // Version it applies to
+  char *url;
+  char *sha256;           // Hex digest of the delta, or NULL if not listed
+  bool binary;            // Between prebuilt packages for this platform,
+                          // rather than between source tarballs
+} PkgRegistryDelta;
+
 // Registry package entry
 typedef struct {
   char *name;
   char *latest_version;
   char *description;
   char *download_url;
+  char *sha256;           // Hex digest of the tarball, or NULL if not listed
+  char *tags;             // Space-separated tags, or NULL
+  char *binary_url;       // Prebuilt package for this machine's platform
+  char *binary_sha256;    // (see pkg_platform), or NULL to build from
+                          // download_url's sources
+  PkgRegistryDelta *deltas;  // For this platform's binaries or sources
+  int delta_count;
 } PkgRegistryEntry;
 
 // Registry response containing multiple packages
@@ -21,7 +45,7 @@ typedef struct {
   int capacity;
 } PkgRegistryList;
 
-// Get the registry URL (from env or default)
+// Get the configured registry URL(s) (from env or default)
 const char *pkg_registry_get_url(void);
 
 // Fetch all packages from registry
@@ -33,13 +57,72 @@ PkgRegistryList *pkg_registry_fetch_all(void);
 // pkg_registry_entry_free()
 PkgRegistryEntry *pkg_registry_fetch_package(const char *name);
 
-// Search packages by name (substring match)
+// Fetch the latest versions of the named packages with one request
+// (POST /packages/versions); entries have only name and latest_version,
+// and names the registry does not know are left out
+// Returns NULL on error or if the registry has no such endpoint, caller
+// must free with pkg_registry_list_free()
+PkgRegistryList *pkg_registry_fetch_versions(const char *const *names,
+                                             int count);
+
+// Search packages by name, tags and description (substring match, best
+// matches first), from the local search index where it is recent
 // Returns NULL on error, caller must free with pkg_registry_list_free()
 PkgRegistryList *pkg_registry_search(const char *query);
 
-// Download a package tarball to a local path
-// Returns 0 on success, -1 on error
-int pkg_registry_download(const char *url, const char *dest_path);
+// Receives a download's body as it arrives
+// Returns 0 to go on, -1 to abort the download
+typedef int (*PkgDownloadSink)(const void *data, size_t len, void *ctx);
+
+// Download a package tarball, handing its body to sink as it arrives
+// Returns 0 on success, -1 on error or if sink aborted
+int pkg_registry_download(const char *url, PkgDownloadSink sink, void *ctx);
+
+// Download a package tarball as up to segments byte ranges over parallel
+// connections, spooled to a temporary file and handed to sink in order
+// once every range has arrived; falls back to pkg_registry_download()
+// where the server does not take ranges or the file is too small
+// Returns 0 on success, -1 on error or if sink aborted
+int pkg_registry_download_segmented(const char *url, int segments,
+                                    PkgDownloadSink sink, void *ctx);
+
+// Downloads in flight at once for install all and upgrade
+#define PKG_DOWNLOAD_PARALLEL 8
+
+// One download for pkg_registry_download_all()
+typedef struct {
+  const char *url;
+  PkgDownloadSink sink;
+  void *ctx;
+} PkgDownload;
+
+// Called as each download finishes, with 0 on success or -1 on error
+typedef void (*PkgDownloadDone)(int index, int result, void *ctx);
+
+// Download several files at once, up to max_parallel at a time, reusing
+// connections (and multiplexing them over HTTP/2 where libcurl and the
+// server support it). done is called as each one finishes, in the order
+// they finish; a failed download may already have given part of its body
+// to its sink.
+// Returns 0 if all succeeded, -1 if any failed
+int pkg_registry_download_all(const PkgDownload *downloads, int count,
+                              int max_parallel, PkgDownloadDone done,
+                              void *ctx);
+
+// Tarball to install for an entry: the prebuilt one for this platform
+// if the registry has it, else the source tarball
+const char *pkg_registry_entry_url(const PkgRegistryEntry *entry);
+
+// Digest of the tarball pkg_registry_entry_url() names, or NULL
+const char *pkg_registry_entry_sha256(const PkgRegistryEntry *entry);
+
+// Delta to the tarball pkg_registry_entry_url() names from version from,
+// installed from this platform's prebuilt package if binary, else from
+// sources; a delta cannot turn one kind into the other
+// Returns NULL if the registry lists none
+const PkgRegistryDelta *pkg_registry_entry_delta(const PkgRegistryEntry *entry,
+                                                 const char *from,
+                                                 bool binary);
 
 // Free a registry entry
 void pkg_registry_entry_free(PkgRegistryEntry *entry);
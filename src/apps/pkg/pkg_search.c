@@ -0,0 +1,674 @@
+/** @file pkg_search.c
+ *  @brief Search index of the registry's package listing.
+ *
+ *  The index is an n-gram inverted index: for each 1- to 3-byte substring
+ *  of the lowercased names, tags and descriptions it lists the packages
+ *  containing it. A query of up to three bytes is a single lookup; a
+ *  longer one intersects the postings of its trigrams and only checks the
+ *  packages left over, so searches keep their substring semantics without
+ *  scanning the listing. The file is mapped like the command index, and
+ *  its mtime records when pkg last checked the listing with the registry.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pkg_search.h"
+#include "pkg_utils.h"
+
+
+/** A matching package and how well it matched. */
+typedef struct {
+  uint32_t package;
+  int rank;                // Lower is better
+  const char *name;
+} SearchHit;
+
+
+/** Gets the path of the search index.
+ *  @return Allocated path to ~/.jshell/cache/packages.idx, or NULL on
+ *          error. Caller must free.
+ */
+static char *index_path(void) {
+  char *cache_dir = pkg_get_cache_dir();
+  if (cache_dir == NULL) {
+    return NULL;
+  }
+
+  size_t len = strlen(cache_dir) + strlen("/packages.idx") + 1;
+  char *path = malloc(len);
+  if (path != NULL) {
+    snprintf(path, len, "%s/packages.idx", cache_dir);
+  }
+  free(cache_dir);
+  return path;
+}
+
+
+/** Packs a substring of up to three bytes into a gram key.
+ *  @param s Lowercased bytes
+ *  @param len Number of bytes, 1 to 3
+ *  @return Gram key
+ */
+static uint32_t gram_key(const char *s, size_t len) {
+  uint32_t key = (uint32_t)len << 24;
+  for (size_t i = 0; i < len; i++) {
+    key |= (uint32_t)(unsigned char)s[i] << (16 - 8 * i);
+  }
+  return key;
+}
+
+
+/** Copies a string in lowercase.
+ *  @param s String, or NULL
+ *  @return Allocated lowercase copy ("" for NULL), or NULL on error.
+ *          Caller must free.
+ */
+static char *lowercase(const char *s) {
+  char *lower = strdup(s != NULL ? s : "");
+  if (lower != NULL) {
+    for (char *p = lower; *p; p++) {
+      *p = (char)tolower((unsigned char)*p);
+    }
+  }
+  return lower;
+}
+
+
+/** Orders packed (gram, package) pairs.
+ *  @param a First pair
+ *  @param b Second pair
+ *  @return Comparison result for qsort
+ */
+static int compare_pairs(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+
+/** Checks an index image and points idx at its tables.
+ *  @param idx Index to fill in
+ *  @param map Index image
+ *  @param size Size of the image
+ *  @param registry Registry URL the index must belong to
+ *  @return 0 if the image is a valid index for registry, -1 otherwise
+ */
+static int attach(PkgSearchIndex *idx, void *map, size_t size,
+                  const char *registry) {
+  if (size < sizeof(PkgSearchHeader)) {
+    return -1;
+  }
+
+  const PkgSearchHeader *header = map;
+  const char *base = map;
+  size_t grams_end = sizeof(PkgSearchHeader)
+                     + (size_t)header->count * sizeof(PkgSearchPackage)
+                     + (size_t)header->gram_count * sizeof(PkgSearchGram);
+
+  // The last byte must end a string, so any in-range offset is terminated
+  bool valid = memcmp(header->magic, PKG_SEARCH_MAGIC,
+                      sizeof(header->magic)) == 0
+               && header->postings_offset >= grams_end
+               && header->postings_offset % sizeof(uint32_t) == 0
+               && header->strings_offset >= header->postings_offset
+               && header->strings_offset < size
+               && base[size - 1] == '\0'
+               && header->registry < size - header->strings_offset;
+  if (!valid || strcmp(base + header->strings_offset + header->registry,
+                       registry) != 0) {
+    return -1;
+  }
+
+  idx->map = map;
+  idx->map_size = size;
+  idx->header = header;
+  idx->packages = (const PkgSearchPackage *)(base + sizeof(PkgSearchHeader));
+  idx->grams = (const PkgSearchGram *)(idx->packages + header->count);
+  idx->postings = (const uint32_t *)(base + header->postings_offset);
+  idx->strings = base + header->strings_offset;
+  idx->strings_size = size - header->strings_offset;
+  return 0;
+}
+
+
+/** Maps the search index of a registry's listing.
+ *  @param idx Index to fill in
+ *  @param registry Registry URL
+ *  @return 0 on success, -1 if missing, malformed or for another registry
+ */
+int pkg_search_index_open(PkgSearchIndex *idx, const char *registry) {
+  memset(idx, 0, sizeof(*idx));
+
+  char *path = index_path();
+  if (path == NULL) {
+    return -1;
+  }
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  free(path);
+  if (fd < 0) {
+    return -1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(PkgSearchHeader)) {
+    close(fd);
+    return -1;
+  }
+
+  size_t size = (size_t)st.st_size;
+  void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return -1;
+  }
+
+  if (attach(idx, map, size, registry) != 0) {
+    munmap(map, size);
+    memset(idx, 0, sizeof(*idx));
+    return -1;
+  }
+  idx->mapped = true;
+  idx->mtime = st.st_mtime;
+  return 0;
+}
+
+
+/** Builds the search index of a listing in memory.
+ *  @param idx Index to fill in
+ *  @param registry Registry URL the listing came from
+ *  @param list Package listing
+ *  @param listing_hash Hash of the listing, to spot it changing
+ *  @return 0 on success, -1 on error
+ */
+int pkg_search_index_build(PkgSearchIndex *idx, const char *registry,
+                           const PkgRegistryList *list,
+                           uint64_t listing_hash) {
+  memset(idx, 0, sizeof(*idx));
+  if (registry == NULL || list == NULL) {
+    return -1;
+  }
+  uint32_t count = (uint32_t)list->count;
+
+  // Every gram of every searchable field, paired with its package
+  size_t pair_cap = 256;
+  size_t pair_count = 0;
+  uint64_t *pairs = malloc(pair_cap * sizeof(uint64_t));
+  if (pairs == NULL) {
+    return -1;
+  }
+
+  size_t strings_size = strlen(registry) + 1;
+  for (uint32_t i = 0; i < count; i++) {
+    const PkgRegistryEntry *entry = &list->entries[i];
+    const char *fields[] = {entry->name, entry->tags, entry->description};
+    for (size_t f = 0; f < sizeof(fields) / sizeof(fields[0]); f++) {
+      char *text = lowercase(fields[f]);
+      if (text == NULL) {
+        free(pairs);
+        return -1;
+      }
+      size_t len = strlen(text);
+      for (size_t pos = 0; pos < len; pos++) {
+        for (size_t n = 1; n <= 3 && pos + n <= len; n++) {
+          if (pair_count == pair_cap) {
+            pair_cap *= 2;
+            uint64_t *grown = realloc(pairs, pair_cap * sizeof(uint64_t));
+            if (grown == NULL) {
+              free(text);
+              free(pairs);
+              return -1;
+            }
+            pairs = grown;
+          }
+          pairs[pair_count++] = (uint64_t)gram_key(text + pos, n) << 32 | i;
+        }
+      }
+      free(text);
+    }
+
+    const char *strings[] = {entry->name, entry->latest_version,
+                             entry->description, entry->tags,
+                             entry->download_url, entry->sha256};
+    for (size_t s = 0; s < sizeof(strings) / sizeof(strings[0]); s++) {
+      if (strings[s] != NULL) {
+        strings_size += strlen(strings[s]) + 1;
+      }
+    }
+  }
+
+  qsort(pairs, pair_count, sizeof(uint64_t), compare_pairs);
+  size_t unique = 0;
+  uint32_t gram_count = 0;
+  for (size_t i = 0; i < pair_count; i++) {
+    if (unique > 0 && pairs[i] == pairs[unique - 1]) {
+      continue;
+    }
+    if (unique == 0 || pairs[i] >> 32 != pairs[unique - 1] >> 32) {
+      gram_count++;
+    }
+    pairs[unique++] = pairs[i];
+  }
+
+  size_t postings_offset = sizeof(PkgSearchHeader)
+                           + (size_t)count * sizeof(PkgSearchPackage)
+                           + (size_t)gram_count * sizeof(PkgSearchGram);
+  size_t strings_offset = postings_offset + unique * sizeof(uint32_t);
+  size_t size = strings_offset + strings_size;
+  if (size > UINT32_MAX) {
+    free(pairs);
+    return -1;
+  }
+
+  char *buf = calloc(1, size);
+  if (buf == NULL) {
+    free(pairs);
+    return -1;
+  }
+
+  PkgSearchHeader *header = (PkgSearchHeader *)buf;
+  memcpy(header->magic, PKG_SEARCH_MAGIC, sizeof(header->magic));
+  header->count = count;
+  header->gram_count = gram_count;
+  header->postings_offset = (uint32_t)postings_offset;
+  header->strings_offset = (uint32_t)strings_offset;
+  header->registry = 0;
+  header->listing_hash = listing_hash;
+
+  char *strings = buf + strings_offset;
+  size_t pos = strlen(registry) + 1;
+  memcpy(strings, registry, pos);
+
+  PkgSearchPackage *packages = (PkgSearchPackage *)(header + 1);
+  for (uint32_t i = 0; i < count; i++) {
+    const PkgRegistryEntry *entry = &list->entries[i];
+    const char *values[] = {entry->name, entry->latest_version,
+                            entry->description, entry->tags,
+                            entry->download_url, entry->sha256};
+    uint32_t *offsets[] = {&packages[i].name, &packages[i].version,
+                           &packages[i].description, &packages[i].tags,
+                           &packages[i].download_url, &packages[i].sha256};
+    for (size_t s = 0; s < sizeof(values) / sizeof(values[0]); s++) {
+      if (values[s] == NULL) {
+        *offsets[s] = PKG_SEARCH_NO_STRING;
+        continue;
+      }
+      size_t len = strlen(values[s]) + 1;
+      memcpy(strings + pos, values[s], len);
+      *offsets[s] = (uint32_t)pos;
+      pos += len;
+    }
+  }
+
+  PkgSearchGram *grams = (PkgSearchGram *)(packages + count);
+  uint32_t *postings = (uint32_t *)(buf + postings_offset);
+  uint32_t g = 0;
+  for (size_t i = 0; i < unique; i++) {
+    uint32_t key = (uint32_t)(pairs[i] >> 32);
+    if (i == 0 || key != grams[g - 1].gram) {
+      grams[g].gram = key;
+      grams[g].first = (uint32_t)i;
+      grams[g].count = 0;
+      g++;
+    }
+    grams[g - 1].count++;
+    postings[i] = (uint32_t)pairs[i];
+  }
+  free(pairs);
+
+  if (attach(idx, buf, size, registry) != 0) {
+    free(buf);
+    memset(idx, 0, sizeof(*idx));
+    return -1;
+  }
+  idx->mtime = time(NULL);
+  return 0;
+}
+
+
+/** Writes a buffer to a descriptor, retrying short writes.
+ *  @param fd Descriptor to write to
+ *  @param buf Data
+ *  @param len Length of data
+ *  @return 0 on success, -1 on error
+ */
+static int write_all(int fd, const void *buf, size_t len) {
+  const char *p = buf;
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+
+/** Writes an index to disk.
+ *  The file is written to a temporary name and renamed, so a mapped old
+ *  index stays intact.
+ *  @param idx Index built with pkg_search_index_build
+ *  @return 0 on success, -1 on error
+ */
+int pkg_search_index_save(const PkgSearchIndex *idx) {
+  if (idx->map == NULL || pkg_ensure_cache_dir() != 0) {
+    return -1;
+  }
+
+  char *path = index_path();
+  if (path == NULL) {
+    return -1;
+  }
+
+  size_t tmp_len = strlen(path) + 32;
+  char *tmp_path = malloc(tmp_len);
+  if (tmp_path == NULL) {
+    free(path);
+    return -1;
+  }
+  snprintf(tmp_path, tmp_len, "%s.tmp.%ld", path, (long)getpid());
+
+  int result = -1;
+  int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd >= 0) {
+    int written = write_all(fd, idx->map, idx->map_size);
+    if (close(fd) == 0 && written == 0 && rename(tmp_path, path) == 0) {
+      result = 0;
+    }
+    if (result != 0) {
+      unlink(tmp_path);
+    }
+  }
+
+  free(tmp_path);
+  free(path);
+  return result;
+}
+
+
+/** Marks the on-disk index as checked against the registry just now. */
+void pkg_search_index_touch(void) {
+  char *path = index_path();
+  if (path != NULL) {
+    utimensat(AT_FDCWD, path, NULL, 0);
+    free(path);
+  }
+}
+
+
+/** Unmaps or frees an index.
+ *  @param idx Index (may be unopened)
+ */
+void pkg_search_index_close(PkgSearchIndex *idx) {
+  if (idx->map != NULL) {
+    if (idx->mapped) {
+      munmap(idx->map, idx->map_size);
+    } else {
+      free(idx->map);
+    }
+  }
+  memset(idx, 0, sizeof(*idx));
+}
+
+
+/** Checks whether an index is recent enough to answer without the
+ *  registry.
+ *  @param idx Open index
+ *  @param max_age Maximum age in seconds
+ *  @return true if the listing was checked within max_age seconds
+ */
+bool pkg_search_index_fresh(const PkgSearchIndex *idx, time_t max_age) {
+  time_t now = time(NULL);
+  return idx->map != NULL && idx->mtime <= now
+         && now - idx->mtime < max_age;
+}
+
+
+/** Resolves a string table offset.
+ *  @param idx Open index
+ *  @param offset Offset into the string table
+ *  @return String, or NULL if absent or out of range
+ */
+static const char *index_string(const PkgSearchIndex *idx, uint32_t offset) {
+  if (offset == PKG_SEARCH_NO_STRING || offset >= idx->strings_size) {
+    return NULL;
+  }
+  return idx->strings + offset;
+}
+
+
+/** Finds the postings of a gram.
+ *  @param idx Open index
+ *  @param key Gram key
+ *  @param count Set to the number of postings
+ *  @return First posting, or NULL if no package contains the gram
+ */
+static const uint32_t *find_gram(const PkgSearchIndex *idx, uint32_t key,
+                                 uint32_t *count) {
+  size_t total = (idx->header->strings_offset - idx->header->postings_offset)
+                 / sizeof(uint32_t);
+  size_t lo = 0;
+  size_t hi = idx->header->gram_count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (idx->grams[mid].gram < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  if (lo == idx->header->gram_count || idx->grams[lo].gram != key
+      || idx->grams[lo].first > total
+      || idx->grams[lo].count > total - idx->grams[lo].first) {
+    *count = 0;
+    return NULL;
+  }
+  *count = idx->grams[lo].count;
+  return idx->postings + idx->grams[lo].first;
+}
+
+
+/** Checks whether a sorted posting list contains a package.
+ *  @param list Postings
+ *  @param count Number of postings
+ *  @param package Package index
+ *  @return true if present
+ */
+static bool postings_contain(const uint32_t *list, uint32_t count,
+                             uint32_t package) {
+  size_t lo = 0;
+  size_t hi = count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (list[mid] < package) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo < count && list[lo] == package;
+}
+
+
+/** Checks whether a string contains a lowercase query, ignoring case.
+ *  @param s String, or NULL
+ *  @param query Lowercased query
+ *  @param len Length of query
+ *  @return Position of the first match, or -1
+ */
+static long find_ci(const char *s, const char *query, size_t len) {
+  if (s == NULL) {
+    return -1;
+  }
+  for (const char *p = s; *p; p++) {
+    size_t i = 0;
+    while (i < len && p[i]
+           && tolower((unsigned char)p[i]) == (unsigned char)query[i]) {
+      i++;
+    }
+    if (i == len) {
+      return p - s;
+    }
+  }
+  return len == 0 ? 0 : -1;
+}
+
+
+/** Orders search hits by rank, then name.
+ *  @param a First SearchHit
+ *  @param b Second SearchHit
+ *  @return Comparison result for qsort
+ */
+static int compare_hits(const void *a, const void *b) {
+  const SearchHit *x = a;
+  const SearchHit *y = b;
+  if (x->rank != y->rank) {
+    return x->rank - y->rank;
+  }
+  return strcmp(x->name, y->name);
+}
+
+
+/** Copies a string from the index.
+ *  @param idx Open index
+ *  @param offset String table offset
+ *  @param out Set to an allocated copy, or NULL if absent
+ *  @return 0 on success, -1 on allocation failure
+ */
+static int copy_string(const PkgSearchIndex *idx, uint32_t offset,
+                       char **out) {
+  const char *s = index_string(idx, offset);
+  *out = s != NULL ? strdup(s) : NULL;
+  return s != NULL && *out == NULL ? -1 : 0;
+}
+
+
+/** Searches an index for packages matching a query.
+ *  @param idx Open index
+ *  @param query Search query
+ *  @return Allocated PkgRegistryList of matches, best first, or NULL on
+ *          error. Caller must free with pkg_registry_list_free.
+ */
+PkgRegistryList *pkg_search_index_query(const PkgSearchIndex *idx,
+                                        const char *query) {
+  if (idx->map == NULL || query == NULL) {
+    return NULL;
+  }
+
+  char *q = lowercase(query);
+  PkgRegistryList *results = calloc(1, sizeof(PkgRegistryList));
+  if (q == NULL || results == NULL) {
+    free(q);
+    free(results);
+    return NULL;
+  }
+  size_t len = strlen(q);
+  uint32_t count = idx->header->count;
+
+  // Candidates contain every trigram of the query (or the whole query,
+  // if it is shorter); the rarest one drives the scan
+  const uint32_t *candidates = NULL;
+  uint32_t candidate_count = count;
+  size_t grams = len == 0 ? 0 : len <= 3 ? 1 : len - 2;
+  for (size_t i = 0; i < grams; i++) {
+    uint32_t n;
+    const uint32_t *list = find_gram(idx, gram_key(q + i, len < 3 ? len : 3),
+                                     &n);
+    if (i == 0 || n < candidate_count) {
+      candidates = list;
+      candidate_count = n;
+    }
+  }
+
+  SearchHit *hits = malloc((candidate_count > 0 ? candidate_count : 1)
+                           * sizeof(SearchHit));
+  if (hits == NULL) {
+    free(q);
+    free(results);
+    return NULL;
+  }
+
+  size_t hit_count = 0;
+  for (uint32_t c = 0; c < candidate_count; c++) {
+    uint32_t package = candidates != NULL ? candidates[c] : c;
+    if (package >= count) {
+      continue;
+    }
+
+    bool all_grams = true;
+    for (size_t i = 0; i < grams && all_grams && len > 3; i++) {
+      uint32_t n;
+      const uint32_t *list = find_gram(idx, gram_key(q + i, 3), &n);
+      all_grams = list != NULL && postings_contain(list, n, package);
+    }
+    if (!all_grams) {
+      continue;
+    }
+
+    const PkgSearchPackage *pkg = &idx->packages[package];
+    const char *name = index_string(idx, pkg->name);
+    if (name == NULL) {
+      continue;
+    }
+    long at = find_ci(name, q, len);
+    int rank;
+    if (at == 0 && name[len] == '\0') {
+      rank = 0;
+    } else if (at == 0) {
+      rank = 1;
+    } else if (at > 0) {
+      rank = 2;
+    } else if (find_ci(index_string(idx, pkg->tags), q, len) >= 0) {
+      rank = 3;
+    } else if (find_ci(index_string(idx, pkg->description), q, len) >= 0) {
+      rank = 4;
+    } else {
+      continue;
+    }
+    hits[hit_count++] = (SearchHit){package, rank, name};
+  }
+  free(q);
+
+  qsort(hits, hit_count, sizeof(SearchHit), compare_hits);
+
+  results->entries = calloc(hit_count > 0 ? hit_count : 1,
+                            sizeof(PkgRegistryEntry));
+  if (results->entries == NULL) {
+    free(hits);
+    free(results);
+    return NULL;
+  }
+  results->capacity = (int)(hit_count > 0 ? hit_count : 1);
+
+  for (size_t i = 0; i < hit_count; i++) {
+    const PkgSearchPackage *pkg = &idx->packages[hits[i].package];
+    PkgRegistryEntry *dest = &results->entries[results->count++];
+    if (copy_string(idx, pkg->name, &dest->name) != 0
+        || copy_string(idx, pkg->version, &dest->latest_version) != 0
+        || copy_string(idx, pkg->description, &dest->description) != 0
+        || copy_string(idx, pkg->tags, &dest->tags) != 0
+        || copy_string(idx, pkg->download_url, &dest->download_url) != 0
+        || copy_string(idx, pkg->sha256, &dest->sha256) != 0) {
+      free(hits);
+      pkg_registry_list_free(results);
+      return NULL;
+    }
+  }
+
+  free(hits);
+  return results;
+}
@@ -0,0 +1,101 @@
+#ifndef PKG_SEARCH_H
+#define PKG_SEARCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "pkg_registry.h"
+
+// Search index of the registry's package listing
+// (~/.jshell/cache/packages.idx)
+//
+// Layout: a PkgSearchHeader, `count` PkgSearchPackage records, `gram_count`
+// PkgSearchGram records sorted by gram, the postings they point into, then
+// a string table of NUL-terminated strings. Every 1-, 2- and 3-byte
+// substring of a package's lowercased name, tags and description is a
+// gram, and its postings list the packages containing it, so a search
+// only looks at packages that contain every trigram of the query. pkg
+// rewrites the index whenever it fetches a changed listing, and `pkg
+// search` answers from it without asking the registry while it is recent.
+
+#define PKG_SEARCH_MAGIC "JPKGSRC1"
+
+// Offset stored for a missing string
+#define PKG_SEARCH_NO_STRING UINT32_MAX
+
+// Seconds an index is used by pkg search before the listing is revalidated
+#define PKG_SEARCH_MAX_AGE 300
+
+typedef struct {
+  char magic[8];
+  uint32_t count;            // Number of packages
+  uint32_t gram_count;       // Number of distinct grams
+  uint32_t postings_offset;  // File offset of the postings
+  uint32_t strings_offset;   // File offset of the string table
+  uint32_t registry;         // String offset of the registry URL
+  uint32_t reserved;
+  uint64_t listing_hash;     // Hash of the listing the index was built from
+} PkgSearchHeader;
+
+typedef struct {
+  uint32_t name;             // String table offsets, or NO_STRING
+  uint32_t version;
+  uint32_t description;
+  uint32_t tags;
+  uint32_t download_url;
+  uint32_t sha256;
+} PkgSearchPackage;
+
+typedef struct {
+  uint32_t gram;             // Length in the top byte, then up to 3 bytes
+  uint32_t first;            // Index of its first posting
+  uint32_t count;            // Number of postings (package indices)
+} PkgSearchGram;
+
+// An open index, mapped from disk or built in memory
+typedef struct {
+  void *map;
+  size_t map_size;
+  bool mapped;               // map came from mmap rather than malloc
+  time_t mtime;              // When the listing was last checked
+  const PkgSearchHeader *header;
+  const PkgSearchPackage *packages;
+  const PkgSearchGram *grams;
+  const uint32_t *postings;
+  const char *strings;
+  size_t strings_size;
+} PkgSearchIndex;
+
+// Map the index; fails if it is missing, malformed or was built from
+// another registry's listing
+// Returns 0 on success, -1 on error
+int pkg_search_index_open(PkgSearchIndex *idx, const char *registry);
+
+// Build an index of list in memory
+// Returns 0 on success, -1 on error
+int pkg_search_index_build(PkgSearchIndex *idx, const char *registry,
+                           const PkgRegistryList *list,
+                           uint64_t listing_hash);
+
+// Write a built index to disk, replacing the old one
+// Returns 0 on success, -1 on error
+int pkg_search_index_save(const PkgSearchIndex *idx);
+
+// Record that the listing behind the on-disk index was just revalidated
+void pkg_search_index_touch(void);
+
+// Unmap or free an index
+void pkg_search_index_close(PkgSearchIndex *idx);
+
+// True if the listing behind the index was checked within max_age seconds
+bool pkg_search_index_fresh(const PkgSearchIndex *idx, time_t max_age);
+
+// Packages whose name, tags or description contain query (ignoring case),
+// best matches first: exact name, name prefix, name, tags, description
+// Returns NULL on error, caller must free with pkg_registry_list_free()
+PkgRegistryList *pkg_search_index_query(const PkgSearchIndex *idx,
+                                        const char *query);
+
+#endif
@@ -0,0 +1,810 @@
+/** @file pkg_tar.c
+ *  @brief In-process creation and extraction of gzipped tarballs.
+ *
+ *  Compressed input is inflated with zlib into a fixed buffer and fed to
+ *  a ustar parser that keeps only the current 512-byte header, so memory
+ *  use does not depend on the size of the package. Every entry is
+ *  created relative to a descriptor of the destination, walking its
+ *  parent directories one at a time with O_NOFOLLOW; a symlink in the
+ *  archive can therefore never redirect a later entry out of it.
+ *
+ *  Tarballs are written as ustar, with GNU long-name entries for paths
+ *  that do not fit its name fields, through jbox_gzip's parallel writer:
+ *  the archive is compressed in independent 1 MiB gzip members on every
+ *  core, which gzip and the extractor here read as one stream.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "pkg_tar.h"
+#include "utils/jbox_gzip.h"
+
+
+#define TAR_BLOCK 512
+
+/** Output buffer for inflate. */
+#define TAR_CHUNK (64 * 1024)
+
+/** Largest GNU long name or pax header accepted. */
+#define TAR_META_MAX (64 * 1024)
+
+/** Compression level of created tarballs, gzip's default. */
+#define TAR_GZIP_LEVEL 6
+
+
+/** What the parser expects next. */
+typedef enum {
+  TAR_HEADER,   // Bytes of a header block
+  TAR_FILE,     // Data of a regular file being written
+  TAR_META,     // Data of a long name or pax header being collected
+  TAR_SKIP,     // Data not extracted, or padding
+  TAR_END       // Anything after the end-of-archive block
+} TarState;
+
+
+struct PkgTarStream {
+  z_stream z;
+  int z_done;               // The last gzip member ended
+  int failed;
+  unsigned char *out;       // Inflated data
+  int dest_fd;              // O_PATH descriptor of the destination
+  TarState state;
+  unsigned char block[TAR_BLOCK];
+  size_t block_len;
+  uint64_t left;            // Data left in the current entry
+  uint64_t pad;             // Padding after it
+  int fd;                   // File being written, or -1
+  char meta_type;           // 'L', 'K' or 'x' while in TAR_META
+  char *meta;
+  size_t meta_len;
+  char *long_name;          // Name for the next entry, from 'L' or pax
+  char *long_link;          // Link target for it, from 'K' or pax
+};
+
+
+/** Parses a numeric header field, octal or GNU base-256.
+ *  @param field Field bytes
+ *  @param len Field length
+ *  @param out Set to the value
+ *  @return 0 on success, -1 if malformed
+ */
+static int parse_number(const unsigned char *field, size_t len,
+                        uint64_t *out) {
+  uint64_t v = 0;
+  if (field[0] & 0x80) {
+    // Base-256: the remaining bits, big-endian
+    v = field[0] & 0x3f;
+    for (size_t i = 1; i < len; i++) {
+      if (v >> 56) return -1;
+      v = (v << 8) | field[i];
+    }
+    *out = v;
+    return 0;
+  }
+
+  size_t i = 0;
+  while (i < len && field[i] == ' ') i++;
+  for (; i < len && field[i] >= '0' && field[i] <= '7'; i++) {
+    if (v >> 60) return -1;
+    v = (v << 3) | (uint64_t)(field[i] - '0');
+  }
+  if (i < len && field[i] != ' ' && field[i] != '\0') return -1;
+  *out = v;
+  return 0;
+}
+
+
+/** Checks a header block's checksum.
+ *  @param block Header block
+ *  @return 1 if it matches, 0 otherwise
+ */
+static int checksum_ok(const unsigned char *block) {
+  uint64_t expected;
+  if (parse_number(block + 148, 8, &expected) != 0) return 0;
+
+  // The checksum field counts as spaces
+  uint64_t sum = 8 * ' ';
+  for (int i = 0; i < TAR_BLOCK; i++) {
+    if (i < 148 || i >= 156) sum += block[i];
+  }
+  return sum == expected;
+}
+
+
+/** Copies a header string field, which need not be NUL-terminated.
+ *  @param field Field bytes
+ *  @param len Field length
+ *  @return Allocated string, or NULL on allocation failure
+ */
+static char *field_string(const unsigned char *field, size_t len) {
+  return strndup((const char *)field, strnlen((const char *)field, len));
+}
+
+
+/** Normalizes an entry name to a path relative to the destination.
+ *  Empty and "." components are dropped, and so are leading slashes, as
+ *  GNU tar does.
+ *  @param name Name from the archive
+ *  @return Allocated path ("" for the destination itself), or NULL if it
+ *          has a ".." component or on allocation failure
+ */
+static char *clean_path(const char *name) {
+  char *path = malloc(strlen(name) + 1);
+  if (path == NULL) return NULL;
+
+  size_t len = 0;
+  const char *p = name;
+  while (*p) {
+    const char *end = strchrnul(p, '/');
+    size_t n = (size_t)(end - p);
+    if (n == 2 && p[0] == '.' && p[1] == '.') {
+      free(path);
+      return NULL;
+    }
+    if (n > 0 && !(n == 1 && p[0] == '.')) {
+      if (len > 0) path[len++] = '/';
+      memcpy(path + len, p, n);
+      len += n;
+    }
+    p = *end ? end + 1 : end;
+  }
+  path[len] = '\0';
+  return path;
+}
+
+
+/** Opens the directory that holds an entry, creating missing ones.
+ *  Each component is opened with O_NOFOLLOW, so an entry cannot be put
+ *  anywhere through a symlink.
+ *  @param s Stream
+ *  @param path Cleaned, non-empty path of the entry
+ *  @param leaf Set to the entry's last component within path
+ *  @return Descriptor of the directory, or -1 on error
+ */
+static int open_parent(PkgTarStream *s, char *path, const char **leaf) {
+  int dir = dup(s->dest_fd);
+  char *p = path;
+  char *slash;
+  while (dir >= 0 && (slash = strchr(p, '/')) != NULL) {
+    *slash = '\0';
+    if (mkdirat(dir, p, 0755) != 0 && errno != EEXIST) {
+      close(dir);
+      dir = -1;
+    } else {
+      int next = openat(dir, p, O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+      close(dir);
+      dir = next;
+    }
+    *slash = '/';
+    p = slash + 1;
+  }
+  *leaf = p;
+  return dir;
+}
+
+
+/** Creates the file, directory or link a header describes.
+ *  @param s Stream
+ *  @param type Type flag of the entry
+ *  @param name Cleaned path of the entry
+ *  @param link Link target, for links
+ *  @param mode Permission bits from the header
+ *  @return 0 on success, -1 on error
+ */
+static int create_entry(PkgTarStream *s, char type, char *name,
+                        const char *link, mode_t mode) {
+  const char *leaf;
+  int dir = open_parent(s, name, &leaf);
+  if (dir < 0) return -1;
+
+  int rc = 0;
+  switch (type) {
+    case '5':
+      if (mkdirat(dir, leaf, mode | 0700) != 0 && errno != EEXIST) rc = -1;
+      break;
+
+    case '2':
+      unlinkat(dir, leaf, 0);
+      rc = symlinkat(link, dir, leaf);
+      break;
+
+    case '1': {
+      // Hard links name an earlier entry of the archive
+      char *target = clean_path(link);
+      const char *target_leaf;
+      int target_dir = target && target[0] ? open_parent(s, target,
+                                                         &target_leaf) : -1;
+      unlinkat(dir, leaf, 0);
+      rc = target_dir >= 0 ? linkat(target_dir, target_leaf, dir, leaf, 0)
+                           : -1;
+      if (target_dir >= 0) close(target_dir);
+      free(target);
+      break;
+    }
+
+    default:
+      s->fd = openat(dir, leaf, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW
+                     | O_CLOEXEC, mode);
+      if (s->fd < 0) rc = -1;
+      break;
+  }
+
+  close(dir);
+  return rc;
+}
+
+
+/** Finishes the current entry and moves on to its padding.
+ *  @param s Stream
+ *  @return 0 on success, -1 on error
+ */
+static int entry_done(PkgTarStream *s);
+
+
+/** Handles a complete header block.
+ *  @param s Stream
+ *  @return 0 on success, -1 on error
+ */
+static int parse_header(PkgTarStream *s) {
+  const unsigned char *b = s->block;
+
+  int zero = 1;
+  for (int i = 0; i < TAR_BLOCK && zero; i++) {
+    zero = b[i] == 0;
+  }
+  if (zero) {
+    s->state = TAR_END;
+    return 0;
+  }
+  if (!checksum_ok(b)) return -1;
+
+  uint64_t size, mode;
+  if (parse_number(b + 124, 12, &size) != 0 ||
+      parse_number(b + 100, 8, &mode) != 0) {
+    return -1;
+  }
+  char type = (char)b[156];
+  s->left = size;
+  s->pad = (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+
+  if (type == 'L' || type == 'K' || type == 'x') {
+    if (size > TAR_META_MAX) return -1;
+    s->meta = malloc(size + 1);
+    if (s->meta == NULL) return -1;
+    s->meta_len = 0;
+    s->meta_type = type;
+    s->state = TAR_META;
+    return size == 0 ? entry_done(s) : 0;
+  }
+
+  // Name from a preceding long name record, else prefix/name
+  char *name = s->long_name;
+  s->long_name = NULL;
+  if (name == NULL) {
+    char *base = field_string(b, 100);
+    char *prefix = memcmp(b + 257, "ustar", 5) == 0
+                   ? field_string(b + 345, 155) : NULL;
+    if (base && prefix && prefix[0]) {
+      name = malloc(strlen(prefix) + strlen(base) + 2);
+      if (name) sprintf(name, "%s/%s", prefix, base);
+    } else if (base) {
+      name = strdup(base);
+    }
+    free(base);
+    free(prefix);
+  }
+  char *link = s->long_link ? s->long_link : field_string(b + 157, 100);
+  s->long_link = NULL;
+
+  char *path = name ? clean_path(name) : NULL;
+  int rc = 0;
+  s->state = TAR_SKIP;
+  if (path == NULL || link == NULL) {
+    rc = -1;
+  } else if (path[0] == '\0') {
+    // The destination itself, as "./"
+  } else if (type == '0' || type == '\0' || type == '7') {
+    rc = create_entry(s, type, path, link, (mode_t)(mode & 0777));
+    s->state = TAR_FILE;
+  } else if (type == '5' || type == '2' || type == '1') {
+    rc = create_entry(s, type, path, link, (mode_t)(mode & 0777));
+  }
+  // Devices, FIFOs and global pax headers are skipped
+
+  free(name);
+  free(link);
+  free(path);
+  if (rc != 0) return -1;
+  return s->left == 0 ? entry_done(s) : 0;
+}
+
+
+/** Takes the path and linkpath records of a pax header.
+ *  @param s Stream
+ *  @return 0 on success, -1 if malformed
+ */
+static int parse_pax(PkgTarStream *s) {
+  const char *p = s->meta;
+  const char *end = s->meta + s->meta_len;
+  while (p < end) {
+    // "<length> <key>=<value>\n", length counting the whole record
+    char *after;
+    unsigned long n = strtoul(p, &after, 10);
+    if (after == p || *after != ' ' || n == 0 || n > (size_t)(end - p)) {
+      return -1;
+    }
+    const char *key = after + 1;
+    const char *rec_end = p + n - 1;
+    const char *eq = memchr(key, '=', (size_t)(rec_end - key));
+    if (eq == NULL || *rec_end != '\n') return -1;
+
+    char **field = NULL;
+    if ((size_t)(eq - key) == 4 && memcmp(key, "path", 4) == 0) {
+      field = &s->long_name;
+    } else if ((size_t)(eq - key) == 8 && memcmp(key, "linkpath", 8) == 0) {
+      field = &s->long_link;
+    }
+    if (field) {
+      free(*field);
+      *field = strndup(eq + 1, (size_t)(rec_end - eq - 1));
+      if (*field == NULL) return -1;
+    }
+    p += n;
+  }
+  return 0;
+}
+
+
+static int entry_done(PkgTarStream *s) {
+  int rc = 0;
+  if (s->state == TAR_FILE && s->fd >= 0) {
+    rc = close(s->fd);
+    s->fd = -1;
+  } else if (s->state == TAR_META) {
+    s->meta[s->meta_len] = '\0';
+    if (s->meta_type == 'x') {
+      rc = parse_pax(s);
+    } else {
+      char **field = s->meta_type == 'L' ? &s->long_name : &s->long_link;
+      free(*field);
+      *field = strdup(s->meta);
+      if (*field == NULL) rc = -1;
+    }
+    free(s->meta);
+    s->meta = NULL;
+  }
+
+  s->left = s->pad;
+  s->pad = 0;
+  s->state = s->left > 0 ? TAR_SKIP : TAR_HEADER;
+  return rc;
+}
+
+
+/** Writes a buffer to a descriptor, retrying short writes.
+ *  @param fd Descriptor to write to
+ *  @param buf Data
+ *  @param len Length of data
+ *  @return 0 on success, -1 on error
+ */
+static int write_all(int fd, const unsigned char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    buf += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+
+/** Runs inflated tar data through the parser.
+ *  @param s Stream
+ *  @param data Tar bytes
+ *  @param len Number of bytes
+ *  @return 0 on success, -1 on error
+ */
+static int tar_feed(PkgTarStream *s, const unsigned char *data, size_t len) {
+  while (len > 0) {
+    if (s->state == TAR_END) return 0;
+
+    if (s->state == TAR_HEADER) {
+      size_t n = TAR_BLOCK - s->block_len;
+      if (n > len) n = len;
+      memcpy(s->block + s->block_len, data, n);
+      s->block_len += n;
+      data += n;
+      len -= n;
+      if (s->block_len == TAR_BLOCK) {
+        s->block_len = 0;
+        if (parse_header(s) != 0) return -1;
+      }
+      continue;
+    }
+
+    size_t n = s->left < len ? (size_t)s->left : len;
+    if (s->state == TAR_FILE && write_all(s->fd, data, n) != 0) return -1;
+    if (s->state == TAR_META) {
+      memcpy(s->meta + s->meta_len, data, n);
+      s->meta_len += n;
+    }
+    s->left -= n;
+    data += n;
+    len -= n;
+    if (s->left == 0 && entry_done(s) != 0) return -1;
+  }
+  return 0;
+}
+
+
+/** Creates an extraction stream.
+ *  @param dest_dir Directory to extract into
+ *  @return New stream, or NULL on error
+ */
+PkgTarStream *pkg_tar_stream_new(const char *dest_dir) {
+  PkgTarStream *s = calloc(1, sizeof(PkgTarStream));
+  if (s == NULL) return NULL;
+  s->fd = -1;
+  s->out = malloc(TAR_CHUNK);
+  s->dest_fd = open(dest_dir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+  // 15 window bits, +32 to take the gzip header
+  if (s->out == NULL || s->dest_fd < 0 ||
+      inflateInit2(&s->z, 15 + 32) != Z_OK) {
+    if (s->dest_fd >= 0) close(s->dest_fd);
+    free(s->out);
+    free(s);
+    return NULL;
+  }
+  return s;
+}
+
+
+/** Feeds compressed data to a stream.
+ *  @param s Stream
+ *  @param data Next bytes of the .tar.gz
+ *  @param len Number of bytes
+ *  @return 0 on success, -1 on error
+ */
+int pkg_tar_stream_write(PkgTarStream *s, const void *data, size_t len) {
+  if (s->failed) return -1;
+  if (len == 0) return 0;
+
+  // Another gzip member follows the last
+  if (s->z_done) {
+    inflateReset(&s->z);
+    s->z_done = 0;
+  }
+
+  const unsigned char *in = data;
+  while (len > 0 && !s->failed) {
+    uInt piece = len > UINT32_MAX ? UINT32_MAX : (uInt)len;
+    s->z.next_in = (Bytef *)in;
+    s->z.avail_in = piece;
+
+    do {
+      s->z.next_out = s->out;
+      s->z.avail_out = TAR_CHUNK;
+      int rc = inflate(&s->z, Z_NO_FLUSH);
+      if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
+        s->failed = 1;
+        break;
+      }
+      if (tar_feed(s, s->out, TAR_CHUNK - s->z.avail_out) != 0) {
+        s->failed = 1;
+        break;
+      }
+      if (rc == Z_STREAM_END) {
+        s->z_done = 1;
+        if (s->z.avail_in == 0) break;
+        inflateReset(&s->z);
+        s->z_done = 0;
+      } else if (rc == Z_BUF_ERROR) {
+        break;
+      }
+    } while (s->z.avail_in > 0 || s->z.avail_out == 0);
+
+    in += piece;
+    len -= piece;
+  }
+
+  return s->failed ? -1 : 0;
+}
+
+
+/** Completes extraction and frees the stream.
+ *  @param s Stream, or NULL
+ *  @return 0 if the whole archive was extracted, -1 otherwise
+ */
+int pkg_tar_stream_finish(PkgTarStream *s) {
+  if (s == NULL) return -1;
+
+  // Some writers leave out the end-of-archive blocks
+  int ok = !s->failed && s->z_done &&
+           (s->state == TAR_END ||
+            (s->state == TAR_HEADER && s->block_len == 0));
+
+  if (s->fd >= 0) close(s->fd);
+  close(s->dest_fd);
+  inflateEnd(&s->z);
+  free(s->out);
+  free(s->meta);
+  free(s->long_name);
+  free(s->long_link);
+  free(s);
+  return ok ? 0 : -1;
+}
+
+
+/** Extracts a .tar.gz file.
+ *  @param tarball Path of the tarball
+ *  @param dest_dir Directory to extract into
+ *  @return 0 on success, -1 on error
+ */
+int pkg_tar_extract_file(const char *tarball, const char *dest_dir) {
+  int fd = open(tarball, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return -1;
+
+  PkgTarStream *s = pkg_tar_stream_new(dest_dir);
+  if (s == NULL) {
+    close(fd);
+    return -1;
+  }
+
+  unsigned char buf[TAR_CHUNK];
+  ssize_t n;
+  int rc = 0;
+  while ((n = read(fd, buf, sizeof(buf))) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      rc = -1;
+      break;
+    }
+    if (pkg_tar_stream_write(s, buf, (size_t)n) != 0) {
+      rc = -1;
+      break;
+    }
+  }
+  close(fd);
+
+  if (pkg_tar_stream_finish(s) != 0) rc = -1;
+  return rc;
+}
+
+
+/** Writes a numeric header field as octal, or base-256 if too large.
+ *  @param field Field bytes
+ *  @param len Field length, the terminating NUL included
+ *  @param v Value
+ */
+static void put_number(unsigned char *field, size_t len, uint64_t v) {
+  if (len - 1 < 22 && v >> (3 * (len - 1)) != 0) {
+    memset(field, 0, len);
+    field[0] = 0x80;
+    for (size_t i = len - 1; i > 0 && v != 0; i--, v >>= 8) {
+      field[i] = (unsigned char)v;
+    }
+    return;
+  }
+  snprintf((char *)field, len, "%0*llo", (int)(len - 1),
+           (unsigned long long)v);
+}
+
+
+/** Writes a header block.
+ *  @param gz Compressed output
+ *  @param name Entry name, at most 100 bytes, or NULL if already in block
+ *  @param type Type flag
+ *  @param mode Permission bits
+ *  @param size Bytes of data that follow
+ *  @param mtime Modification time
+ *  @param link Link target, at most 100 bytes, or NULL
+ *  @param block Header to fill in, zeroed, with any prefix already set
+ *  @return 0 on success, -1 on write error
+ */
+static int put_header(jbox_gzip_writer_t *gz, const char *name, char type,
+                      mode_t mode, uint64_t size, int64_t mtime,
+                      const char *link, unsigned char *block) {
+  if (name != NULL) memcpy(block, name, strlen(name));
+  put_number(block + 100, 8, mode);
+  put_number(block + 108, 8, 0);
+  put_number(block + 116, 8, 0);
+  put_number(block + 124, 12, size);
+  put_number(block + 136, 12, mtime > 0 ? (uint64_t)mtime : 0);
+  block[156] = (unsigned char)type;
+  if (link != NULL) memcpy(block + 157, link, strlen(link));
+  memcpy(block + 257, "ustar", 6);
+  memcpy(block + 263, "00", 2);
+
+  // The checksum counts its own field as spaces
+  memset(block + 148, ' ', 8);
+  unsigned sum = 0;
+  for (int i = 0; i < TAR_BLOCK; i++) sum += block[i];
+  snprintf((char *)block + 148, 8, "%06o", sum);
+  block[155] = ' ';
+  return jbox_gzip_write(gz, block, TAR_BLOCK);
+}
+
+
+/** Writes data followed by zeros up to the next block boundary.
+ *  @param gz Compressed output
+ *  @param data Bytes to write
+ *  @param len Number of bytes
+ *  @return 0 on success, -1 on write error
+ */
+static int put_padded(jbox_gzip_writer_t *gz, const void *data, size_t len) {
+  static const unsigned char zeros[TAR_BLOCK];
+  if (jbox_gzip_write(gz, data, len) != 0) return -1;
+  size_t pad = (TAR_BLOCK - len % TAR_BLOCK) % TAR_BLOCK;
+  return jbox_gzip_write(gz, zeros, pad);
+}
+
+
+/** Writes a GNU long-name ('L') or long-link ('K') entry.
+ *  @param gz Compressed output
+ *  @param type 'L' or 'K'
+ *  @param text Name or link target
+ *  @return 0 on success, -1 on write error
+ */
+static int put_long(jbox_gzip_writer_t *gz, char type, const char *text) {
+  unsigned char block[TAR_BLOCK] = {0};
+  size_t len = strlen(text) + 1;
+  if (put_header(gz, "././@LongLink", type, 0644, len, 0, NULL, block) != 0) {
+    return -1;
+  }
+  return put_padded(gz, text, len);
+}
+
+
+/** Writes the header of one entry, with long-name entries as needed.
+ *  @param gz Compressed output
+ *  @param e Entry
+ *  @param size Bytes of data that follow
+ *  @return 0 on success, -1 on write error or a name too long (errno set)
+ */
+static int put_entry_header(jbox_gzip_writer_t *gz, const PkgFileEntry *e,
+                            uint64_t size) {
+  char name[PATH_MAX + 2];
+  int len = snprintf(name, sizeof(name), "%s%s", e->path,
+                     e->type == DT_DIR ? "/" : "");
+  if (len < 0 || (size_t)len >= sizeof(name)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  unsigned char block[TAR_BLOCK] = {0};
+  const char *short_name = name;
+  if (len > 100) {
+    // ustar splits a long name at a slash into prefix and name
+    const char *slash = NULL;
+    for (const char *p = name + len - 101; p < name + len; p++) {
+      if (*p == '/' && p > name && p - name <= 155 && p[1] != '\0') {
+        slash = p;
+        break;
+      }
+    }
+    if (slash != NULL) {
+      memcpy(block + 345, name, (size_t)(slash - name));
+      short_name = slash + 1;
+    } else {
+      if (put_long(gz, 'L', name) != 0) return -1;
+      name[100] = '\0';
+    }
+  }
+
+  const char *link = e->link;
+  if (link != NULL && strlen(link) > 100) {
+    if (put_long(gz, 'K', link) != 0) return -1;
+    link = NULL;
+  }
+
+  char type = e->type == DT_DIR ? '5' : e->type == DT_LNK ? '2' : '0';
+  return put_header(gz, short_name, type, e->mode, size, e->mtime, link,
+                    block);
+}
+
+
+/** Copies a regular file into the archive.
+ *  @param gz Compressed output
+ *  @param dir_fd Package directory
+ *  @param e Entry, whose size is what the header promised
+ *  @return 0 on success, -1 on write error (errno set), -2 if the file
+ *          could not be read (printed)
+ */
+static int put_file_data(jbox_gzip_writer_t *gz, int dir_fd,
+                         const PkgFileEntry *e) {
+  int fd = openat(dir_fd, e->path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "pkg build: cannot read %s: %s\n", e->path,
+            strerror(errno));
+    return -2;
+  }
+
+  unsigned char buf[TAR_CHUNK];
+  uint64_t left = e->size;
+  int rc = 0;
+  while (left > 0 && rc == 0) {
+    ssize_t n = read(fd, buf, left < sizeof(buf) ? left : sizeof(buf));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      fprintf(stderr, "pkg build: %s changed while packing\n", e->path);
+      rc = -2;
+      break;
+    }
+    rc = jbox_gzip_write(gz, buf, (size_t)n);
+    left -= (uint64_t)n;
+  }
+  close(fd);
+
+  static const unsigned char zeros[TAR_BLOCK];
+  size_t pad = (TAR_BLOCK - e->size % TAR_BLOCK) % TAR_BLOCK;
+  return rc == 0 ? jbox_gzip_write(gz, zeros, pad) : rc;
+}
+
+
+/** Writes a .tar.gz of a scanned directory.
+ *  @param fd Output descriptor
+ *  @param src_dir Directory the entries are in
+ *  @param files Entries to pack, in order
+ *  @param manifest Contents for pkg.json
+ *  @return 0 on success, -1 on error
+ */
+int pkg_tar_create(int fd, const char *src_dir, const PkgFileList *files,
+                   const char *manifest) {
+  int dir_fd = open(src_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd < 0) {
+    fprintf(stderr, "pkg build: %s: %s\n", src_dir, strerror(errno));
+    return -1;
+  }
+  jbox_gzip_writer_t *gz = jbox_gzip_writer_new(fd, TAR_GZIP_LEVEL, 0);
+  if (gz == NULL) {
+    fprintf(stderr, "pkg build: out of memory\n");
+    close(dir_fd);
+    return -1;
+  }
+
+  // -1 for a write error, with errno set; -2 once reported
+  int rc = 0;
+  for (size_t i = 0; i < files->count && rc == 0; i++) {
+    const PkgFileEntry *e = &files->items[i];
+    if (e->type == DT_REG && strcmp(e->path, "pkg.json") == 0) {
+      size_t len = strlen(manifest);
+      rc = put_entry_header(gz, e, len);
+      if (rc == 0) rc = put_padded(gz, manifest, len);
+    } else if (e->type == DT_REG) {
+      rc = put_entry_header(gz, e, e->size);
+      if (rc == 0) rc = put_file_data(gz, dir_fd, e);
+    } else {
+      rc = put_entry_header(gz, e, 0);
+    }
+  }
+
+  // End of archive: two zero blocks
+  static const unsigned char zeros[2 * TAR_BLOCK];
+  if (rc == 0) rc = jbox_gzip_write(gz, zeros, sizeof(zeros));
+  int err = errno;
+  if (jbox_gzip_writer_close(gz, rc == 0) != 0 && rc == 0) {
+    err = errno;
+    rc = -1;
+  }
+  if (rc == -1) {
+    fprintf(stderr, "pkg build: cannot write tarball: %s\n", strerror(err));
+  }
+  close(dir_fd);
+  return rc == 0 ? 0 : -1;
+}
@@ -0,0 +1,43 @@
+#ifndef PKG_TAR_H
+#define PKG_TAR_H
+
+#include <stddef.h>
+
+#include "pkg_files.h"
+
+// In-process creation and extraction of gzipped tarballs (.tar.gz)
+//
+// A stream takes the compressed bytes in pieces of any size, as they come
+// off the network, and writes each entry into the destination directory
+// as soon as its data arrives. Nothing is staged in a temporary file and
+// no tar process is run. ustar, GNU long names and pax path records are
+// understood; entries that would land outside the destination (absolute
+// paths, "..", or links pointing out of it) make the extraction fail.
+
+typedef struct PkgTarStream PkgTarStream;
+
+// Start extracting into dest_dir, which must exist
+// Returns NULL on allocation failure
+PkgTarStream *pkg_tar_stream_new(const char *dest_dir);
+
+// Feed the next len bytes of the .tar.gz
+// Returns 0 on success, -1 if the data is not a valid tarball or an
+// entry could not be written (later calls fail too)
+int pkg_tar_stream_write(PkgTarStream *s, const void *data, size_t len);
+
+// Check the tarball ended cleanly and free the stream
+// Returns 0 if everything was extracted, -1 otherwise
+int pkg_tar_stream_finish(PkgTarStream *s);
+
+// Extract a .tar.gz file into dest_dir
+// Returns 0 on success, -1 on error
+int pkg_tar_extract_file(const char *tarball, const char *dest_dir);
+
+// Write a .tar.gz of the entries of src_dir listed in files, compressed
+// on all cores, to fd. Entries are named by their paths below src_dir;
+// pkg.json gets the contents of manifest instead of its own.
+// Returns 0 on success, -1 on error (printed)
+int pkg_tar_create(int fd, const char *src_dir, const PkgFileList *files,
+                   const char *manifest);
+
+#endif
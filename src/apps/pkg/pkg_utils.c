@@ -2,11 +2,13 @@
  *  @brief Utility functions for package management (paths, file I/O, etc).
  */
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/utsname.h>
 #include <sys/wait.h>
 #include <dirent.h>
 #include <errno.h>
@@ -100,6 +102,50 @@ char *pkg_get_db_path(void) {
 }
 
 
+/** Gets the package database journal file path.
+ *  @return Allocated path string, or NULL on error. Caller must free.
+ */
+char *pkg_get_journal_path(void) {
+  char *pkgs = pkg_get_pkgs_dir();
+  if (pkgs == NULL) {
+    return NULL;
+  }
+
+  size_t len = strlen(pkgs) + strlen("/pkgdb.journal") + 1;
+  char *path = malloc(len);
+  if (path == NULL) {
+    free(pkgs);
+    return NULL;
+  }
+
+  snprintf(path, len, "%s/pkgdb.journal", pkgs);
+  free(pkgs);
+  return path;
+}
+
+
+/** Gets the binary package index file path.
+ *  @return Allocated path string, or NULL on error. Caller must free.
+ */
+char *pkg_get_index_path(void) {
+  char *pkgs = pkg_get_pkgs_dir();
+  if (pkgs == NULL) {
+    return NULL;
+  }
+
+  size_t len = strlen(pkgs) + strlen("/pkgdb.idx") + 1;
+  char *path = malloc(len);
+  if (path == NULL) {
+    free(pkgs);
+    return NULL;
+  }
+
+  snprintf(path, len, "%s/pkgdb.idx", pkgs);
+  free(pkgs);
+  return path;
+}
+
+
 /** Gets the legacy package database file path (text format).
  *  @return Allocated path string, or NULL on error. Caller must free.
  */
@@ -144,6 +190,52 @@ char *pkg_get_tmp_dir(void) {
 }
 
 
+/** Gets the directory of files shared between installed packages.
+ *  @return Allocated path string (~/.jshell/pkgs/_store), or NULL on error.
+ *          Caller must free.
+ */
+char *pkg_get_store_dir(void) {
+  char *pkgs = pkg_get_pkgs_dir();
+  if (pkgs == NULL) {
+    return NULL;
+  }
+
+  size_t len = strlen(pkgs) + strlen("/_store") + 1;
+  char *path = malloc(len);
+  if (path == NULL) {
+    free(pkgs);
+    return NULL;
+  }
+
+  snprintf(path, len, "%s/_store", pkgs);
+  free(pkgs);
+  return path;
+}
+
+
+/** Gets the download cache directory path.
+ *  @return Allocated path string (~/.jshell/cache), or NULL on error.
+ *          Caller must free.
+ */
+char *pkg_get_cache_dir(void) {
+  char *home = pkg_get_home_dir();
+  if (home == NULL) {
+    return NULL;
+  }
+
+  size_t len = strlen(home) + strlen("/cache") + 1;
+  char *path = malloc(len);
+  if (path == NULL) {
+    free(home);
+    return NULL;
+  }
+
+  snprintf(path, len, "%s/cache", home);
+  free(home);
+  return path;
+}
+
+
 /** Ensures a directory exists, creating it if necessary.
  *  @param path Directory path
  *  @return 0 on success, -1 on error
@@ -339,6 +431,53 @@ char *pkg_read_file(const char *path) {
   return content;
 }
 
+/** Describes the platform prebuilt packages must have been built for.
+ *  The OS and machine come from uname, as pkg.mk tags the packages it
+ *  builds; on Linux the C library follows, since a binary linked
+ *  against glibc does not run on musl or the other way round.
+ *  @param buf Buffer receiving the tag
+ *  @param size Size of buf
+ *  @return 0 on success, -1 if there is no tag
+ */
+int pkg_platform(char *buf, size_t size) {
+  if (size == 0) {
+    return -1;
+  }
+  buf[0] = '\0';
+
+  const char *env = getenv("JSHELL_PKG_PLATFORM");
+  if (env != NULL) {
+    if (*env == '\0' || strlen(env) >= size) {
+      return -1;
+    }
+    snprintf(buf, size, "%s", env);
+    return 0;
+  }
+
+  struct utsname u;
+  if (uname(&u) != 0) {
+    return -1;
+  }
+
+  const char *libc = "";
+  if (strcmp(u.sysname, "Linux") == 0) {
+#ifdef __GLIBC__
+    libc = "-gnu";
+#else
+    libc = "-musl";
+#endif
+  }
+  int n = snprintf(buf, size, "%s-%s%s", u.sysname, u.machine, libc);
+  if (n < 0 || (size_t)n >= size) {
+    buf[0] = '\0';
+    return -1;
+  }
+  for (char *p = buf; *p != '\0'; p++) {
+    *p = (char)tolower((unsigned char)*p);
+  }
+  return 0;
+}
+
 
 /** Ensures the temporary directory exists.
  *  @return 0 on success, -1 on error
@@ -359,6 +498,44 @@ int pkg_ensure_tmp_dir(void) {
 }
 
 
+/** Ensures the shared file store exists.
+ *  @return 0 on success, -1 on error
+ */
+int pkg_ensure_store_dir(void) {
+  if (pkg_ensure_dirs() != 0) {
+    return -1;
+  }
+
+  char *store = pkg_get_store_dir();
+  if (store == NULL) {
+    return -1;
+  }
+
+  int result = ensure_dir(store);
+  free(store);
+  return result;
+}
+
+
+/** Ensures the download cache directory exists.
+ *  @return 0 on success, -1 on error
+ */
+int pkg_ensure_cache_dir(void) {
+  if (pkg_ensure_dirs() != 0) {
+    return -1;
+  }
+
+  char *cache = pkg_get_cache_dir();
+  if (cache == NULL) {
+    return -1;
+  }
+
+  int result = ensure_dir(cache);
+  free(cache);
+  return result;
+}
+
+
 /** Removes the temporary directory and all its contents.
  *  @return 0 on success, -1 on error
  */
@@ -1,6 +1,8 @@
 #ifndef PKG_UTILS_H
 #define PKG_UTILS_H
 
+#include <stddef.h>
+
 // Returns path to ~/.jshell (caller must free)
 char *pkg_get_home_dir(void);
 
@@ -13,12 +15,24 @@ char *pkg_get_bin_dir(void);
 // Returns path to ~/.jshell/pkgs/pkgdb.json (caller must free)
 char *pkg_get_db_path(void);
 
+// Returns path to ~/.jshell/pkgs/pkgdb.journal (caller must free)
+char *pkg_get_journal_path(void);
+
+// Returns path to ~/.jshell/pkgs/pkgdb.idx (caller must free)
+char *pkg_get_index_path(void);
+
 // Returns path to ~/.jshell/pkgdb.txt (legacy, caller must free)
 char *pkg_get_db_path_txt(void);
 
 // Returns path to ~/.jshell/pkgs/_tmp (caller must free)
 char *pkg_get_tmp_dir(void);
 
+// Returns path to ~/.jshell/pkgs/_store (caller must free)
+char *pkg_get_store_dir(void);
+
+// Returns path to ~/.jshell/cache (caller must free)
+char *pkg_get_cache_dir(void);
+
 // Creates ~/.jshell, ~/.jshell/pkgs, ~/.jshell/bin if needed
 // Returns 0 on success, -1 on error
 int pkg_ensure_dirs(void);
@@ -27,6 +41,14 @@ int pkg_ensure_dirs(void);
 // Returns 0 on success, -1 on error
 int pkg_ensure_tmp_dir(void);
 
+// Ensures ~/.jshell/pkgs/_store exists
+// Returns 0 on success, -1 on error
+int pkg_ensure_store_dir(void);
+
+// Ensures ~/.jshell/cache exists
+// Returns 0 on success, -1 on error
+int pkg_ensure_cache_dir(void);
+
 // Cleans up ~/.jshell/pkgs/_tmp contents
 // Returns 0 on success, -1 on error
 int pkg_cleanup_tmp_dir(void);
@@ -43,4 +65,11 @@ int pkg_remove_dir_recursive(const char *path);
 // Returns NULL on error
 char *pkg_read_file(const char *path);
 
+// Writes the tag naming what prebuilt packages this machine runs,
+// "<os>-<machine>[-<libc>]" as in "linux-x86_64-gnu" or "darwin-arm64",
+// into buf; JSHELL_PKG_PLATFORM overrides it, and setting that empty
+// installs every package from source
+// Returns 0 on success, -1 if there is no tag (buf is then empty)
+int pkg_platform(char *buf, size_t size);
+
 #endif
@@ -2,15 +2,35 @@
  *  @brief Search for patterns using regular expressions
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <errno.h>
-#include <regex.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_ctx.h"
 #include "utils/jbox_signals.h"
+#include "utils/jbox_json.h"
+#include "utils/jbox_linereader.h"
+#include "utils/jbox_regex.h"
+#include "rg_decompress.h"
+#include "rg_index.h"
+#include "rg_pattern.h"
+#include "rg_walk.h"
+
+
+/** Upper bound on -e options; -f files may hold any number of patterns */
+#define RG_MAX_PATTERNS 1000
 
 
 /** Argtable structure for rg command arguments */
@@ -20,12 +40,24 @@ typedef struct {
   struct arg_lit *ignore_case;
   struct arg_lit *word_match;
   struct arg_int *context;
+  struct arg_int *max_count;
+  struct arg_int *max_results;
+  struct arg_str *max_filesize;
   struct arg_lit *fixed_strings;
+  struct arg_lit *only_matching;
+  struct arg_lit *count;
+  struct arg_lit *files_with_matches;
   struct arg_lit *json;
+  struct arg_lit *json_stream;
+  struct arg_lit *search_zip;
+  struct arg_str *index;
+  struct arg_lit *indexed;
+  struct arg_str *regexp;
+  struct arg_file *pattern_file;
   struct arg_str *pattern;
   struct arg_file *files;
   struct arg_end *end;
-  void *argtable[10];
+  void *argtable[22];
 } rg_args_t;
 
 
@@ -39,11 +71,42 @@ static void build_rg_argtable(rg_args_t *args) {
   args->ignore_case = arg_lit0("i", NULL, "case-insensitive search");
   args->word_match = arg_lit0("w", NULL, "match whole words only");
   args->context = arg_int0("C", NULL, "N", "show N lines of context");
+  args->max_count = arg_int0("m", "max-count", "NUM",
+                             "stop reading a file after NUM matching lines");
+  args->max_results = arg_int0(NULL, "max-results", "NUM",
+                               "stop after NUM matching lines in all");
+  args->max_filesize = arg_str0(NULL, "max-filesize", "SIZE",
+                                "skip files larger than SIZE bytes (K, M "
+                                "or G suffix)");
   args->fixed_strings = arg_lit0(NULL, "fixed-strings",
                                  "treat pattern as literal string");
+  args->only_matching = arg_lit0("o", "only-matching",
+                                 "print only the matched parts of lines");
+  args->count = arg_lit0("c", "count",
+                         "print the number of matching lines per file");
+  args->files_with_matches = arg_lit0("l", "files-with-matches",
+                                      "print only names of files with a "
+                                      "match");
   args->json = arg_lit0(NULL, "json", "output in JSON format");
-  args->pattern = arg_str1(NULL, NULL, "PATTERN", "search pattern (regex)");
-  args->files = arg_filen(NULL, NULL, "FILE", 0, 100, "files to search");
+  args->json_stream = arg_lit0(NULL, "json-stream",
+                               "output one JSON object per line (NDJSON)");
+  args->search_zip = arg_lit0("z", "search-zip",
+                              "search gzip and zstd compressed files");
+  args->index = arg_str0(NULL, "index", "build",
+                         "build or update the trigram index of each DIR "
+                         "given in place of PATTERN and FILEs");
+  args->indexed = arg_lit0(NULL, "indexed",
+                           "search only the files the trigram index says "
+                           "may match");
+  args->regexp = arg_strn("e", "regexp", "PATTERN", 0, RG_MAX_PATTERNS,
+                         "search for PATTERN; repeat to search for several "
+                         "at once");
+  args->pattern_file = arg_filen("f", "file", "FILE", 0, 100,
+                                 "search for each line of FILE as a "
+                                 "pattern");
+  args->pattern = arg_str0(NULL, NULL, "PATTERN", "search pattern (regex)");
+  args->files = arg_filen(NULL, NULL, "FILE", 0, 100,
+                          "files or directories to search");
   args->end = arg_end(20);
 
   args->argtable[0] = args->help;
@@ -51,11 +114,23 @@ static void build_rg_argtable(rg_args_t *args) {
   args->argtable[2] = args->ignore_case;
   args->argtable[3] = args->word_match;
   args->argtable[4] = args->context;
-  args->argtable[5] = args->fixed_strings;
-  args->argtable[6] = args->json;
-  args->argtable[7] = args->pattern;
-  args->argtable[8] = args->files;
-  args->argtable[9] = args->end;
+  args->argtable[5] = args->max_count;
+  args->argtable[6] = args->max_results;
+  args->argtable[7] = args->max_filesize;
+  args->argtable[8] = args->fixed_strings;
+  args->argtable[9] = args->only_matching;
+  args->argtable[10] = args->count;
+  args->argtable[11] = args->files_with_matches;
+  args->argtable[12] = args->json;
+  args->argtable[13] = args->json_stream;
+  args->argtable[14] = args->search_zip;
+  args->argtable[15] = args->index;
+  args->argtable[16] = args->indexed;
+  args->argtable[17] = args->regexp;
+  args->argtable[18] = args->pattern_file;
+  args->argtable[19] = args->pattern;
+  args->argtable[20] = args->files;
+  args->argtable[21] = args->end;
 }
 
 
@@ -78,7 +153,8 @@ static void rg_print_usage(FILE *out) {
   build_rg_argtable(&args);
   fprintf(out, "Usage: rg");
   arg_print_syntax(out, args.argtable, "\n");
-  fprintf(out, "Search for PATTERN in each FILE.\n\n");
+  fprintf(out, "Search for PATTERN in each FILE, recursing into "
+               "directories.\n\n");
   fprintf(out, "Options:\n");
   arg_print_glossary(out, args.argtable, "  %-20s %s\n");
   cleanup_rg_argtable(&args);
@@ -86,182 +162,203 @@ static void rg_print_usage(FILE *out) {
 
 
 /**
- * Escapes special characters in a string for JSON output.
- * @param str Input string to escape
- * @param out Output buffer for escaped string
- * @param out_size Size of output buffer
- */
-static void escape_json_string(const char *str, char *out, size_t out_size) {
-  size_t j = 0;
-  for (size_t i = 0; str[i] && j < out_size - 1; i++) {
-    char c = str[i];
-    if (c == '"' || c == '\\') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = c;
-    } else if (c == '\n') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = 'n';
-    } else if (c == '\r') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = 'r';
-    } else if (c == '\t') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = 't';
-    } else {
-      out[j++] = c;
-    }
-  }
-  out[j] = '\0';
+ * Passes the rg argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void rg_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  rg_args_t args;
+  build_rg_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_rg_argtable(&args);
 }
 
 
 /**
- * Escapes regex metacharacters for literal string matching.
- * @param pattern Input pattern string
- * @return Newly allocated escaped pattern, or NULL on error
+ * Tells the result cache what the output of rg depends on: everything below
+ * the named paths; not when reading stdin, nor with an index, nor with -e
+ * or -f (PATTERN is a path then, and -f's pattern files are inputs too).
+ *
+ * @param argc Number of arguments
+ * @param argv Array of argument strings
+ * @return How this run may be cached
  */
-static char *escape_regex_pattern(const char *pattern) {
-  size_t len = strlen(pattern);
-  char *escaped = malloc(len * 2 + 1);
-  if (!escaped) return NULL;
-
-  size_t j = 0;
-  for (size_t i = 0; i < len; i++) {
-    char c = pattern[i];
-    if (strchr(".^$*+?()[{\\|", c)) {
-      escaped[j++] = '\\';
-    }
-    escaped[j++] = c;
+static jshell_cmd_cache_t rg_cache_scope(int argc, char **argv) {
+  rg_args_t args;
+  build_rg_argtable(&args);
+  int nerrors = arg_parse(argc, argv, args.argtable);
+  jshell_cmd_cache_t scope = CMD_CACHE_NONE;
+  if (nerrors == 0 && args.help->count == 0
+      && args.files->count > 0 && args.regexp->count == 0
+      && args.pattern_file->count == 0
+      && args.index->count == 0 && args.indexed->count == 0) {
+    scope = CMD_CACHE_TREES;
   }
-  escaped[j] = '\0';
-  return escaped;
+  cleanup_rg_argtable(&args);
+  return scope;
 }
 
 
+/** Upper bound on search threads, whatever the core count */
+#define RG_MAX_WORKERS 64
+
+/** Size of stdout's buffer under --json-stream */
+#define RG_STREAM_BUFFER (256 * 1024)
+
+/** stdout buffer for --json-stream, flushed at file boundaries */
+static char rg_stream_buffer[RG_STREAM_BUFFER];
+
+
 /**
- * Creates a word-boundary pattern for whole-word matching.
- * @param pattern Input pattern string
- * @return Newly allocated word pattern, or NULL on error
+ * Skips to the first line that contains a pattern's literal.
+ *
+ * The buffered data is scanned as a whole rather than line by line; only
+ * the newlines before a hit are counted to keep line numbers right. A
+ * partial last line is kept across reads so hits spanning them are found.
+ *
+ * @param reader Line reader, positioned at the start of a line
+ * @param patterns Patterns with literals, one of which every matching
+ *        line contains
+ * @param line_num Incremented by the number of lines skipped
+ * @return 1 if positioned at a candidate line, 0 at end of input,
+ *         -1 on error, -2 on interrupt
  */
-static char *create_word_pattern(const char *pattern) {
-  size_t len = strlen(pattern);
-  char *word_pat = malloc(len + 20);
-  if (!word_pat) return NULL;
-  snprintf(word_pat, len + 20, "\\b%s\\b", pattern);
-  return word_pat;
+static int line_reader_skip_to(jbox_linereader_t *reader,
+                               const rg_patterns_t *patterns,
+                               int *line_num) {
+  for (;;) {
+    const char *data = reader->buf + reader->start;
+    size_t avail = reader->end - reader->start;
+    const char *hit = rg_patterns_find(patterns, data, avail);
+    if (hit) {
+      const char *nl = memrchr(data, '\n', (size_t)(hit - data));
+      const char *line_start = nl ? nl + 1 : data;
+      *line_num += (int)jbox_linereader_count(data,
+                                              (size_t)(line_start - data));
+      reader->start = (size_t)(line_start - reader->buf);
+      reader->scanned = 0;
+      return 1;
+    }
+    if (reader->eof) {
+      reader->start = reader->end;
+      reader->scanned = 0;
+      return 0;
+    }
+
+    const char *last_nl = memrchr(data, '\n', avail);
+    if (last_nl) {
+      *line_num += (int)jbox_linereader_count(data,
+                                              (size_t)(last_nl + 1 - data));
+      reader->start = (size_t)(last_nl + 1 - reader->buf);
+    }
+    reader->scanned = reader->end - reader->start;
+
+    if (jbox_is_interrupted()) return -2;
+    ssize_t n = jbox_linereader_fill(reader);
+    if (n < 0) return (int)n;
+    if (n == 0) reader->eof = 1;
+  }
 }
 
 
-/** Dynamic buffer for storing file lines */
+/** Context line held back until it is known whether a match follows */
 typedef struct {
-  char **lines;
-  size_t count;
-  size_t capacity;
-} line_buffer_t;
+  char *text;
+  size_t cap;
+  int line;
+} context_entry_t;
 
 
-/**
- * Initializes a line buffer to empty state.
- * @param buf Pointer to line buffer to initialize
- */
-static void line_buffer_init(line_buffer_t *buf) {
-  buf->lines = NULL;
-  buf->count = 0;
-  buf->capacity = 0;
-}
+/** Ring of the last -C lines not yet printed */
+typedef struct {
+  context_entry_t *entries;
+  int size;
+  int head;             /* Oldest entry */
+  int count;
+} context_ring_t;
 
 
 /**
- * Frees all memory associated with a line buffer.
- * @param buf Pointer to line buffer to free
+ * Initializes a context ring.
+ * @param ring Ring to initialize
+ * @param size Number of lines to keep (0 keeps none)
+ * @return 0 on success, -1 on allocation failure
  */
-static void line_buffer_free(line_buffer_t *buf) {
-  for (size_t i = 0; i < buf->count; i++) {
-    free(buf->lines[i]);
-  }
-  free(buf->lines);
-  buf->lines = NULL;
-  buf->count = 0;
-  buf->capacity = 0;
+static int context_ring_init(context_ring_t *ring, int size) {
+  ring->size = size;
+  ring->head = 0;
+  ring->count = 0;
+  ring->entries = NULL;
+  if (size <= 0) return 0;
+  ring->entries = calloc((size_t)size, sizeof(context_entry_t));
+  return ring->entries ? 0 : -1;
 }
 
 
 /**
- * Adds a line to the line buffer.
- * @param buf Pointer to line buffer
- * @param line Line to add (will be duplicated)
- * @return 0 on success, -1 on error
+ * Frees a context ring and its saved lines.
+ * @param ring Ring to free
  */
-static int line_buffer_add(line_buffer_t *buf, const char *line) {
-  if (buf->count >= buf->capacity) {
-    size_t new_cap = buf->capacity == 0 ? 1024 : buf->capacity * 2;
-    char **new_lines = realloc(buf->lines, new_cap * sizeof(char *));
-    if (!new_lines) return -1;
-    buf->lines = new_lines;
-    buf->capacity = new_cap;
+static void context_ring_free(context_ring_t *ring) {
+  for (int i = 0; i < ring->size && ring->entries; i++) {
+    free(ring->entries[i].text);
   }
-  buf->lines[buf->count] = strdup(line);
-  if (!buf->lines[buf->count]) return -1;
-  buf->count++;
-  return 0;
+  free(ring->entries);
+  ring->entries = NULL;
 }
 
 
 /**
- * Reads all lines from a file into a line buffer.
- * @param path File path to read
- * @param buf Line buffer to populate
- * @return 0 on success, -1 on error, -2 on interrupt
+ * Saves a line, replacing the oldest once the ring is full.
+ * @param ring Context ring
+ * @param line Line number
+ * @param text Line text (copied)
+ * @return 0 on success, -1 on allocation failure
  */
-static int read_file_lines(const char *path, line_buffer_t *buf) {
-  FILE *fp = fopen(path, "r");
-  if (!fp) return -1;
-
-  char *line = NULL;
-  size_t line_cap = 0;
-  ssize_t line_len;
+static int context_ring_push(context_ring_t *ring, int line,
+                             const char *text) {
+  if (ring->size <= 0) return 0;
 
-  while ((line_len = getline(&line, &line_cap, fp)) != -1) {
-    /* Check for interrupt */
-    if (jbox_is_interrupted()) {
-      free(line);
-      fclose(fp);
-      return -2;  /* Signal interruption */
-    }
-
-    if (line_len > 0 && line[line_len - 1] == '\n') {
-      line[line_len - 1] = '\0';
-    }
-    if (line_buffer_add(buf, line) != 0) {
-      free(line);
-      fclose(fp);
-      return -1;
-    }
+  int slot = (ring->head + ring->count) % ring->size;
+  if (ring->count == ring->size) {
+    ring->head = (ring->head + 1) % ring->size;
+  } else {
+    ring->count++;
   }
 
-  free(line);
-  fclose(fp);
+  context_entry_t *entry = &ring->entries[slot];
+  size_t len = strlen(text) + 1;
+  if (len > entry->cap) {
+    char *grown = realloc(entry->text, len);
+    if (!grown) return -1;
+    entry->text = grown;
+    entry->cap = len;
+  }
+  memcpy(entry->text, text, len);
+  entry->line = line;
   return 0;
 }
 
 
-/**
- * Finds the column position of the first regex match in a line.
- * @param line Line to search
- * @param regex Compiled regex pattern
- * @return 1-based column position, or 1 if not found
- */
-static int find_column(const char *line, regex_t *regex) {
-  regmatch_t match;
-  if (regexec(regex, line, 1, &match, 0) == 0) {
-    return (int)(match.rm_so + 1);
-  }
-  return 1;
-}
+/** Search and output settings shared by every file searched */
+typedef struct {
+  int show_json;
+  int json_stream;              /* JSON entries as NDJSON, not an array */
+  int show_line_numbers;
+  int show_filename;
+  int context_lines;
+  int max_count;                /* Matching lines per file, 0 for all */
+  int max_results;              /* Matching lines in all, 0 for all */
+  off_t max_filesize;           /* Larger files are skipped, 0 for none */
+  int only_matching;            /* Print each match, not its line (-o) */
+  int count;                    /* Print matching line counts (-c) */
+  int files_with_matches;       /* Print names of matching files (-l) */
+  int search_zip;               /* Decompress gzip and zstd input (-z) */
+  const rg_patterns_t *patterns;
+  atomic_int *stop;             /* Set once --max-results is met, so the
+                                 * file's output will not be printed */
+} rg_options_t;
 
 
 /** Result of a pattern match */
@@ -270,62 +367,178 @@ typedef struct {
   int line;
   int column;
   const char *text;
+  const char *pattern;          /* Pattern matched, when several are given */
 } match_result_t;
 
 
 /**
- * Prints a match result in JSON format.
- * @param match Match result to print
+ * Starts a JSON entry: a separator inside the --json array, nothing for
+ * --json-stream, where each entry ends its own line.
+ * @param out Output stream
+ * @param opts Output settings
  * @param first Pointer to flag indicating if this is the first JSON entry
  */
-static void print_match_json(const match_result_t *match, int *first) {
-  if (!*first) {
-    printf(",\n");
+static void begin_json_entry(FILE *out, const rg_options_t *opts,
+                             int *first) {
+  if (!*first && !opts->json_stream) {
+    fputs(",\n", out);
   }
   *first = 0;
+  fputs("{\"file\": ", out);
+}
 
-  char escaped_file[512];
-  escape_json_string(match->file, escaped_file, sizeof(escaped_file));
 
-  size_t text_len = strlen(match->text);
-  char *escaped_text = malloc(text_len * 2 + 1);
-  if (!escaped_text) {
-    printf("{\"file\": \"%s\", \"line\": %d, \"column\": %d, "
-           "\"text\": \"<error>\"}",
-           escaped_file, match->line, match->column);
-    return;
-  }
-  escape_json_string(match->text, escaped_text, text_len * 2 + 1);
+/**
+ * Ends a JSON entry started with begin_json_entry().
+ * @param out Output stream
+ * @param opts Output settings
+ */
+static void end_json_entry(FILE *out, const rg_options_t *opts) {
+  fputs(opts->json_stream ? "}\n" : "}", out);
+}
 
-  printf("{\"file\": \"%s\", \"line\": %d, \"column\": %d, \"text\": \"%s\"}",
-         escaped_file, match->line, match->column, escaped_text);
 
-  free(escaped_text);
+/**
+ * Prints a match result in JSON format.
+ * @param out Output stream
+ * @param opts Output settings
+ * @param match Match result to print
+ * @param first Pointer to flag indicating if this is the first JSON entry
+ */
+static void print_match_json(FILE *out, const rg_options_t *opts,
+                             const match_result_t *match, int *first) {
+  begin_json_entry(out, opts, first);
+  jbox_json_write_string(out, match->file);
+  fprintf(out, ", \"line\": %d, \"column\": %d, \"text\": ",
+          match->line, match->column);
+  jbox_json_write_string(out, match->text);
+  if (match->pattern) {
+    fprintf(out, ", \"pattern\": ");
+    jbox_json_write_string(out, match->pattern);
+  }
+  end_json_entry(out, opts);
 }
 
 
 /**
  * Prints a match result in text format.
+ * @param out Output stream
  * @param match Match result to print
  * @param show_filename Whether to show filename
  * @param show_line_numbers Whether to show line numbers
  */
-static void print_match_text(const match_result_t *match, int show_filename,
-                             int show_line_numbers) {
+static void print_match_text(FILE *out, const match_result_t *match,
+                             int show_filename, int show_line_numbers) {
   if (show_filename && show_line_numbers) {
-    printf("%s:%d:%s\n", match->file, match->line, match->text);
+    fprintf(out, "%s:%d:%s\n", match->file, match->line, match->text);
   } else if (show_filename) {
-    printf("%s:%s\n", match->file, match->text);
+    fprintf(out, "%s:%s\n", match->file, match->text);
   } else if (show_line_numbers) {
-    printf("%d:%s\n", match->line, match->text);
+    fprintf(out, "%d:%s\n", match->line, match->text);
   } else {
-    printf("%s\n", match->text);
+    fprintf(out, "%s\n", match->text);
+  }
+}
+
+
+/**
+ * Names the pattern a match is of, for JSON output.
+ * @param opts Output settings
+ * @param which Index of the pattern
+ * @return The pattern as given, or NULL when there is only one
+ */
+static const char *pattern_name(const rg_options_t *opts, size_t which) {
+  return opts->patterns->count > 1 ? opts->patterns->given[which] : NULL;
+}
+
+
+/**
+ * Prints every non-empty match in a line on its own (-o).
+ *
+ * The first match is already known; the rest are found by searching on
+ * from the end of the previous one, with the text before it still
+ * deciding ^ and word boundaries.
+ *
+ * @param out Output stream
+ * @param matcher Compiled patterns
+ * @param opts Output settings
+ * @param name Name to report for the input
+ * @param line_num Line number
+ * @param line NUL-terminated line; bytes are patched and restored
+ * @param len Length of line
+ * @param first_match Offsets of the first match in the line
+ * @param first_which Pattern of the first match
+ * @param first_json_entry Pointer to first JSON entry flag
+ */
+static void print_only_matching(FILE *out, rg_matcher_t *matcher,
+                                const rg_options_t *opts, const char *name,
+                                int line_num, char *line, size_t len,
+                                regmatch_t first_match, size_t first_which,
+                                int *first_json_entry) {
+  regmatch_t match = first_match;
+  size_t which = first_which;
+  size_t *want_which = opts->show_json ? &which : NULL;
+  for (;;) {
+    size_t so = (size_t)match.rm_so;
+    size_t eo = (size_t)match.rm_eo;
+    if (eo > so) {
+      char saved = line[eo];
+      line[eo] = '\0';
+      match_result_t result_entry = {
+        .file = name,
+        .line = line_num,
+        .column = (int)so + 1,
+        .text = line + so,
+        .pattern = pattern_name(opts, which)
+      };
+      if (opts->show_json) {
+        print_match_json(out, opts, &result_entry, first_json_entry);
+      } else {
+        print_match_text(out, &result_entry, opts->show_filename,
+                         opts->show_line_numbers);
+      }
+      line[eo] = saved;
+    }
+
+    /* Step past an empty match so the search moves on */
+    size_t from = eo > so ? eo : eo + 1;
+    if (from > len || !rg_matcher_match_at(matcher, line, len, from, &match,
+                                           want_which)) {
+      break;
+    }
+  }
+}
+
+
+/**
+ * Prints the summary of a file for --count or --files-with-matches.
+ * @param out Output stream
+ * @param name Name to report for the input
+ * @param count Number of matching lines, or -1 to print only the name
+ * @param opts Output settings
+ * @param first_json_entry Pointer to first JSON entry flag
+ */
+static void print_file_summary(FILE *out, const char *name, int count,
+                               const rg_options_t *opts,
+                               int *first_json_entry) {
+  if (opts->show_json) {
+    begin_json_entry(out, opts, first_json_entry);
+    jbox_json_write_string(out, name);
+    if (count >= 0) fprintf(out, ", \"count\": %d", count);
+    end_json_entry(out, opts);
+  } else if (count < 0) {
+    fprintf(out, "%s\n", name);
+  } else if (opts->show_filename) {
+    fprintf(out, "%s:%d\n", name, count);
+  } else {
+    fprintf(out, "%d\n", count);
   }
 }
 
 
 /**
  * Prints a context line (before or after a match).
+ * @param out Output stream
  * @param file Filename
  * @param line_num Line number
  * @param text Line text
@@ -333,231 +546,787 @@ static void print_match_text(const match_result_t *match, int show_filename,
  * @param show_line_numbers Whether to show line numbers
  * @param separator Separator character (':' for match, '-' for context)
  */
-static void print_context_line(const char *file, int line_num,
+static void print_context_line(FILE *out, const char *file, int line_num,
                                const char *text, int show_filename,
                                int show_line_numbers, char separator) {
   if (show_filename && show_line_numbers) {
-    printf("%s%c%d%c%s\n", file, separator, line_num, separator, text);
+    fprintf(out, "%s%c%d%c%s\n", file, separator, line_num, separator, text);
   } else if (show_filename) {
-    printf("%s%c%s\n", file, separator, text);
+    fprintf(out, "%s%c%s\n", file, separator, text);
   } else if (show_line_numbers) {
-    printf("%d%c%s\n", line_num, separator, text);
+    fprintf(out, "%d%c%s\n", line_num, separator, text);
   } else {
-    printf("%s\n", text);
+    fprintf(out, "%s\n", text);
   }
 }
 
 
 /**
- * Searches a file for pattern matches.
- * @param path File path to search
- * @param regex Compiled regex pattern
- * @param show_json Whether to output JSON
- * @param show_line_numbers Whether to show line numbers
- * @param show_filename Whether to show filename
- * @param context_lines Number of context lines to show
+ * Searches a descriptor for pattern matches in a single streaming pass.
+ *
+ * Lines before a match come from a ring of the last context_lines
+ * unprinted lines and lines after it are printed as they are read, so
+ * nothing is held beyond the context window. Without context, input is
+ * skipped straight to the next occurrence of a required literal. With
+ * max_count, reading stops after that many matching lines (and the
+ * context after the last one). Reading also stops if opts->stop is set.
+ *
+ * @param fd Descriptor to read from
+ * @param name Name to report for the input
+ * @param matcher Compiled patterns
+ * @param opts Output settings
+ * @param skip_binary Whether to skip input with a NUL in its first chunk
+ * @param flush_matches Whether to flush out after each match
+ * @param out Output stream
  * @param first_json_entry Pointer to first JSON entry flag
- * @param found_any Pointer to flag indicating if any matches found
- * @return 0 on success, 1 on error, -2 on interrupt
+ * @param found_any Incremented for each matching line found (once under
+ *        -l)
+ * @return 0 on success, -1 on read error (errno set), 1 on allocation
+ *         failure, -2 on interrupt
  */
-static int search_file(const char *path, regex_t *regex, int show_json,
-                       int show_line_numbers, int show_filename,
-                       int context_lines, int *first_json_entry,
-                       int *found_any) {
-  line_buffer_t lines;
-  line_buffer_init(&lines);
+static int search_fd(int fd, const char *name, rg_matcher_t *matcher,
+                     const rg_options_t *opts, int skip_binary,
+                     int flush_matches, FILE *out, int *first_json_entry,
+                     int *found_any) {
+  /* Only whole-line output has context lines */
+  int summary = opts->count || opts->files_with_matches;
+  int context_lines = opts->show_json || summary || opts->only_matching
+                      ? 0 : opts->context_lines;
+  /* The match offsets are needed for columns and -o */
+  int want_offsets = !summary && (opts->show_json || opts->only_matching);
+  int match_count = 0;
+  int matched_lines = 0;
+  int limit_reached = 0;
+  int show_filename = opts->show_filename;
+  int show_line_numbers = opts->show_line_numbers;
+
+  jbox_linereader_t reader;
+  context_ring_t ring;
+  if (jbox_linereader_init(&reader, fd) != 0
+      || context_ring_init(&ring, context_lines) != 0) {
+    jbox_linereader_free(&reader);
+    return 1;
+  }
 
-  int read_result = read_file_lines(path, &lines);
-  if (read_result == -2) {
-    return -2;  /* Propagate interruption */
+  int result = 0;
+  int line_num = 0;
+  int last_printed = 0;
+  int after_remaining = 0;
+  int need_separator = 0;
+  char *line = NULL;
+  size_t line_len = 0;
+  int rc = 1;
+  const rg_patterns_t *patterns = opts->patterns;
+  int skip_ahead = patterns->literals != NULL && context_lines == 0;
+  /* Only JSON match entries say which of several patterns matched */
+  int want_which = want_offsets && opts->show_json && patterns->count > 1;
+
+  if (skip_binary) {
+    ssize_t n = jbox_linereader_fill(&reader);
+    if (n < 0) {
+      rc = (int)n;
+    } else if (n == 0) {
+      reader.eof = 1;
+    } else if (memchr(reader.buf, '\0', reader.end)) {
+      rc = 0;           /* Binary file: nothing to report */
+    }
   }
-  if (read_result != 0) {
-    if (show_json) {
-      if (!*first_json_entry) printf(",\n");
-      *first_json_entry = 0;
-      char escaped_path[512];
-      escape_json_string(path, escaped_path, sizeof(escaped_path));
-      printf("{\"file\": \"%s\", \"error\": \"%s\"}",
-             escaped_path, strerror(errno));
+
+  while (rc == 1) {
+    if (limit_reached && after_remaining == 0) {
+      rc = 0;
+      break;
+    }
+    if (skip_ahead
+        && (rc = line_reader_skip_to(&reader, patterns, &line_num)) != 1) {
+      break;
+    }
+    if ((rc = jbox_linereader_next(&reader, &line, &line_len)) != 1) {
+      break;
+    }
+    if (jbox_is_interrupted()) {
+      rc = -2;
+      break;
+    }
+    if (opts->stop && atomic_load_explicit(opts->stop, memory_order_relaxed)) {
+      rc = 0;
+      break;
+    }
+    line_num++;
+
+    regmatch_t match = { 0, 0 };
+    size_t which = 0;
+    if (limit_reached
+        || !rg_matcher_match(matcher, line, line_len,
+                             want_offsets ? &match : NULL,
+                             want_which ? &which : NULL)) {
+      if (after_remaining > 0) {
+        print_context_line(out, name, line_num, line, show_filename,
+                           show_line_numbers, '-');
+        last_printed = line_num;
+        after_remaining--;
+      } else if (context_ring_push(&ring, line_num, line) != 0) {
+        result = 1;
+        break;
+      }
+      continue;
+    }
+    (*found_any)++;
+    int column = (int)match.rm_so + 1;
+    limit_reached = opts->max_count > 0
+                    && ++matched_lines >= opts->max_count;
+
+    if (opts->files_with_matches) {
+      /* One hit settles it: stop reading the file */
+      print_file_summary(out, name, -1, opts, first_json_entry);
+      rc = 0;
+      break;
+    } else if (opts->count) {
+      match_count++;
+      continue;
+    } else if (opts->only_matching) {
+      print_only_matching(out, matcher, opts, name, line_num, line,
+                          line_len, match, which, first_json_entry);
+    } else if (opts->show_json) {
+      match_result_t result_entry = {
+        .file = name,
+        .line = line_num,
+        .column = column,
+        .text = line,
+        .pattern = pattern_name(opts, which)
+      };
+      print_match_json(out, opts, &result_entry, first_json_entry);
+    } else if (context_lines > 0) {
+      int first = ring.count > 0 ? ring.entries[ring.head].line : line_num;
+      if (need_separator && first > last_printed + 1) {
+        fprintf(out, "--\n");
+      }
+      for (int i = 0; i < ring.count; i++) {
+        context_entry_t *entry = &ring.entries[(ring.head + i) % ring.size];
+        print_context_line(out, name, entry->line, entry->text,
+                           show_filename, show_line_numbers, '-');
+      }
+      ring.head = 0;
+      ring.count = 0;
+
+      print_context_line(out, name, line_num, line, show_filename,
+                         show_line_numbers, ':');
+      last_printed = line_num;
+      after_remaining = context_lines;
+      need_separator = 1;
     } else {
-      fprintf(stderr, "rg: %s: %s\n", path, strerror(errno));
+      match_result_t result_entry = {
+        .file = name,
+        .line = line_num,
+        .column = column,
+        .text = line
+      };
+      print_match_text(out, &result_entry, show_filename, show_line_numbers);
+    }
+
+    if (flush_matches) {
+      fflush(out);
     }
+  }
+
+  if (opts->count && match_count > 0 && rc == 0 && result == 0) {
+    print_file_summary(out, name, match_count, opts, first_json_entry);
+  }
+
+  int saved_errno = errno;
+  context_ring_free(&ring);
+  jbox_linereader_free(&reader);
+  if (result != 0) return result;
+  if (rc < 0) {
+    errno = saved_errno;
+    return rc;
+  }
+  return 0;
+}
+
+
+/**
+ * Reports a file that could not be searched.
+ * @param out Output stream for JSON entries
+ * @param path File path
+ * @param message What went wrong
+ * @param opts Output settings
+ * @param first_json_entry Pointer to first JSON entry flag
+ */
+static void report_file_message(FILE *out, const char *path,
+                                const char *message,
+                                const rg_options_t *opts,
+                                int *first_json_entry) {
+  if (opts->show_json) {
+    begin_json_entry(out, opts, first_json_entry);
+    jbox_json_write_string(out, path);
+    fprintf(out, ", \"error\": ");
+    jbox_json_write_string(out, message);
+    end_json_entry(out, opts);
+  } else {
+    fprintf(stderr, "rg: %s: %s\n", path, message);
+  }
+}
+
+
+/**
+ * Reports a file that could not be opened or read.
+ * @param out Output stream for JSON entries
+ * @param path File path
+ * @param error errno value
+ * @param opts Output settings
+ * @param first_json_entry Pointer to first JSON entry flag
+ */
+static void report_file_error(FILE *out, const char *path, int error,
+                              const rg_options_t *opts,
+                              int *first_json_entry) {
+  report_file_message(out, path, strerror(error), opts, first_json_entry);
+}
+
+
+/**
+ * Searches an open input, through a decompressor under -z.
+ *
+ * Matches are flushed as they are found when the input is a pipe or
+ * terminal and the output is stdout, so results from a live stream are
+ * seen as they arrive.
+ *
+ * @param fd Descriptor to read from
+ * @param name Name to report for the input
+ * @param matcher Compiled patterns
+ * @param opts Output settings
+ * @param skip_binary Whether to skip input that looks binary
+ * @param out Output stream
+ * @param first_json_entry Pointer to first JSON entry flag
+ * @param found_any Incremented for each matching line found
+ * @return 0 on success, 1 on error (reported), -2 on interrupt
+ */
+static int search_input(int fd, const char *name, rg_matcher_t *matcher,
+                        const rg_options_t *opts, int skip_binary,
+                        FILE *out, int *first_json_entry, int *found_any) {
+  struct stat st;
+  int flush_matches = out == jbox_stdout()
+                      && (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode));
+
+  int text_fd = fd;
+  rg_decompress_t *dec = NULL;
+  if (opts->search_zip && rg_decompress_start(fd, &text_fd, &dec) != 0) {
+    report_file_error(out, name, errno, opts, first_json_entry);
     return 1;
   }
 
-  int *matched = calloc(lines.count, sizeof(int));
-  if (!matched) {
-    line_buffer_free(&lines);
+  int rc = search_fd(text_fd, name, matcher, opts, skip_binary,
+                     flush_matches, out, first_json_entry, found_any);
+  if (rc == -1) {
+    report_file_error(out, name, errno, opts, first_json_entry);
+    rc = 1;
+  }
+  const char *error = rg_decompress_finish(dec);
+  if (error && rc == 0) {
+    report_file_message(out, name, error, opts, first_json_entry);
+    rc = 1;
+  }
+  return rc;
+}
+
+
+/**
+ * Searches a file for pattern matches, unless it is over --max-filesize,
+ * which is checked before anything is read.
+ * @param path File path to search
+ * @param matcher Compiled patterns
+ * @param opts Output settings
+ * @param skip_binary Whether to skip the file if it looks binary
+ * @param out Output stream
+ * @param first_json_entry Pointer to first JSON entry flag
+ * @param found_any Incremented for each matching line found
+ * @return 0 on success, 1 on error, -2 on interrupt
+ */
+static int search_file(const char *path, rg_matcher_t *matcher,
+                       const rg_options_t *opts, int skip_binary, FILE *out,
+                       int *first_json_entry, int *found_any) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    report_file_error(out, path, errno, opts, first_json_entry);
     return 1;
   }
+  struct stat st;
+  if (opts->max_filesize > 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+      && st.st_size > opts->max_filesize) {
+    close(fd);
+    return 0;
+  }
+  /* Files are read front to back; let the kernel read further ahead.
+   * Overlap across files comes from the search workers */
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  int rc = search_input(fd, path, matcher, opts, skip_binary, out,
+                        first_json_entry, found_any);
+  close(fd);
+  return rc;
+}
+
 
-  for (size_t i = 0; i < lines.count; i++) {
-    if (regexec(regex, lines.lines[i], 0, NULL, 0) == 0) {
-      matched[i] = 1;
-      *found_any = 1;
+/**
+ * Searches standard input for pattern matches.
+ * @param matcher Compiled patterns
+ * @param opts Output settings
+ * @param first_json_entry Pointer to first JSON entry flag
+ * @param found_any Incremented for each matching line found
+ * @return 0 on success, 1 on error, -2 on interrupt
+ */
+static int search_stdin(rg_matcher_t *matcher, const rg_options_t *opts,
+                        int *first_json_entry, int *found_any) {
+  rg_options_t stdin_opts = *opts;
+  stdin_opts.show_filename = 0;
+  return search_input(jbox_stdin_fd(), "(stdin)", matcher, &stdin_opts, 0,
+                      jbox_stdout(), first_json_entry, found_any);
+}
+
+
+/** A file to search and, once searched, its buffered output */
+typedef struct {
+  char *path;
+  int skip_binary;      /* Found by directory traversal */
+  char *output;
+  size_t output_len;
+  int has_json;         /* output holds at least one JSON entry */
+  int found;            /* Matching lines found */
+  int status;           /* search_file() result */
+  int done;             /* Guarded by rg_pool_t.done_lock */
+} rg_task_t;
+
+
+/** Contiguous run of task indexes owned by one worker */
+typedef struct {
+  pthread_mutex_t lock;
+  size_t next;          /* Owner takes from the front */
+  size_t end;           /* Thieves take from the back */
+} rg_deque_t;
+
+
+/** Work-stealing pool searching a task list */
+typedef struct {
+  rg_task_t *tasks;
+  size_t task_count;
+  rg_deque_t *deques;
+  int worker_count;
+  const rg_options_t *opts;     /* Patterns each worker compiles */
+  jbox_ctx_t *ctx;      /* Invocation the workers search for */
+  atomic_int stop;      /* --max-results met: search no further */
+  pthread_mutex_t done_lock;
+  pthread_cond_t done_cond;
+} rg_pool_t;
+
+
+/** Per-thread argument for rg_worker */
+typedef struct {
+  rg_pool_t *pool;
+  int id;
+} rg_worker_arg_t;
+
+
+/**
+ * Takes the next task for a worker: the front of its own deque, or else
+ * the back half of another worker's.
+ * @param pool Worker pool
+ * @param id Worker index
+ * @param index Set to the task index
+ * @return 1 if a task was taken, 0 if no work is left
+ */
+static int take_task(rg_pool_t *pool, int id, size_t *index) {
+  rg_deque_t *own = &pool->deques[id];
+  pthread_mutex_lock(&own->lock);
+  if (own->next < own->end) {
+    *index = own->next++;
+    pthread_mutex_unlock(&own->lock);
+    return 1;
+  }
+  pthread_mutex_unlock(&own->lock);
+
+  for (int i = 1; i < pool->worker_count; i++) {
+    rg_deque_t *victim = &pool->deques[(id + i) % pool->worker_count];
+    pthread_mutex_lock(&victim->lock);
+    size_t left = victim->end - victim->next;
+    if (left == 0) {
+      pthread_mutex_unlock(&victim->lock);
+      continue;
     }
+    size_t start = victim->next + left / 2;
+    size_t end = victim->end;
+    victim->end = start;
+    pthread_mutex_unlock(&victim->lock);
+
+    /* Only this worker refills its own empty deque */
+    pthread_mutex_lock(&own->lock);
+    own->next = start + 1;
+    own->end = end;
+    pthread_mutex_unlock(&own->lock);
+    *index = start;
+    return 1;
   }
+  return 0;
+}
 
-  int last_printed = -1;
-  int need_separator = 0;
 
-  for (size_t i = 0; i < lines.count; i++) {
-    if (!matched[i]) continue;
+/**
+ * Searches a task's file into its output buffer.
+ * @param task Task, with no output yet
+ * @param matcher Compiled patterns
+ * @param opts Output settings
+ */
+static void search_task(rg_task_t *task, rg_matcher_t *matcher,
+                        const rg_options_t *opts) {
+  int first_json_entry = 1;
+  FILE *out = open_memstream(&task->output, &task->output_len);
+  if (!out) {
+    task->status = 1;
+    return;
+  }
+  task->status = search_file(task->path, matcher, opts, task->skip_binary,
+                             out, &first_json_entry, &task->found);
+  fclose(out);
+  task->has_json = !first_json_entry;
+}
+
 
-    if (show_json) {
-      match_result_t match = {
-        .file = path,
-        .line = (int)(i + 1),
-        .column = find_column(lines.lines[i], regex),
-        .text = lines.lines[i]
-      };
-      print_match_json(&match, first_json_entry);
-    } else {
-      if (context_lines > 0) {
-        int ctx_start = (int)i - context_lines;
-        if (ctx_start < 0) ctx_start = 0;
-        int ctx_end = (int)i + context_lines;
-        if (ctx_end >= (int)lines.count) ctx_end = (int)lines.count - 1;
-
-        if (need_separator && ctx_start > last_printed + 1) {
-          printf("--\n");
-        }
-
-        for (int j = ctx_start; j <= ctx_end; j++) {
-          if (j <= last_printed) continue;
-
-          if (matched[j]) {
-            print_context_line(path, j + 1, lines.lines[j], show_filename,
-                               show_line_numbers, ':');
-          } else {
-            print_context_line(path, j + 1, lines.lines[j], show_filename,
-                               show_line_numbers, '-');
-          }
-          last_printed = j;
-        }
-        need_separator = 1;
-      } else {
-        match_result_t match = {
-          .file = path,
-          .line = (int)(i + 1),
-          .column = find_column(lines.lines[i], regex),
-          .text = lines.lines[i]
-        };
-        print_match_text(&match, show_filename, show_line_numbers);
-      }
+/**
+ * Worker thread: searches tasks into memory buffers until none are left.
+ * @param arg rg_worker_arg_t for this worker
+ * @return NULL
+ */
+static void *rg_worker(void *arg) {
+  rg_worker_arg_t *worker = arg;
+  rg_pool_t *pool = worker->pool;
+  jbox_ctx_adopt(pool->ctx);
+
+  /* The DFA's state cache grows as it matches, so compile our own */
+  rg_matcher_t matcher;
+  char err[256];
+  int compiled = rg_matcher_init(&matcher, pool->opts->patterns, err,
+                                 sizeof(err)) == 0;
+
+  size_t index;
+  while (take_task(pool, worker->id, &index)) {
+    rg_task_t *task = &pool->tasks[index];
+
+    if (!compiled) {
+      task->status = 1;
+    } else if (jbox_is_interrupted()) {
+      task->status = -2;
+    } else if (!atomic_load_explicit(&pool->stop, memory_order_relaxed)) {
+      search_task(task, &matcher, pool->opts);
     }
+
+    pthread_mutex_lock(&pool->done_lock);
+    task->done = 1;
+    pthread_cond_broadcast(&pool->done_cond);
+    pthread_mutex_unlock(&pool->done_lock);
   }
 
-  free(matched);
-  line_buffer_free(&lines);
-  return 0;
+  if (compiled) rg_matcher_free(&matcher);
+  return NULL;
 }
 
 
 /**
- * Searches standard input for pattern matches.
- * @param regex Compiled regex pattern
- * @param show_json Whether to output JSON
- * @param show_line_numbers Whether to show line numbers
- * @param context_lines Number of context lines to show
+ * Searches tasks on a pool of threads, printing each file's output whole
+ * and in task order as soon as it and every earlier file are done.
+ *
+ * Under --max-results each file is searched for at most that many
+ * matching lines (opts->max_count is capped to it), and the file at
+ * which the total runs out is searched again here for just the lines
+ * still wanted, so the output is the first results in path order, as a
+ * sequential search would print them. The workers then abandon the rest.
+ *
+ * @param tasks Tasks to search
+ * @param task_count Number of tasks
+ * @param matcher Compiled patterns, for searching a file again
+ * @param opts Output settings, with the patterns each worker compiles
  * @param first_json_entry Pointer to first JSON entry flag
  * @param found_any Pointer to flag indicating if any matches found
- * @return 0 on success, 1 on error, -2 on interrupt
+ * @return 0 on success, 1 if any file failed, -2 on interrupt
  */
-static int search_stdin(regex_t *regex, int show_json, int show_line_numbers,
-                        int context_lines, int *first_json_entry,
-                        int *found_any) {
-  line_buffer_t lines;
-  line_buffer_init(&lines);
+static int search_parallel(rg_task_t *tasks, size_t task_count,
+                           rg_matcher_t *matcher, const rg_options_t *opts,
+                           int *first_json_entry, int *found_any) {
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int worker_count = cores > 0 ? (int)cores : 1;
+  if (worker_count > RG_MAX_WORKERS) worker_count = RG_MAX_WORKERS;
+  if ((size_t)worker_count > task_count) worker_count = (int)task_count;
+
+  rg_pool_t pool = {
+    .tasks = tasks,
+    .task_count = task_count,
+    .worker_count = worker_count,
+    .ctx = jbox_ctx_current(),
+  };
+  rg_options_t worker_opts = *opts;
+  worker_opts.stop = &pool.stop;
+  pool.opts = &worker_opts;
+  atomic_init(&pool.stop, 0);
+  pool.deques = calloc((size_t)worker_count, sizeof(rg_deque_t));
+  pthread_t *threads = calloc((size_t)worker_count, sizeof(pthread_t));
+  rg_worker_arg_t *args = calloc((size_t)worker_count,
+                                 sizeof(rg_worker_arg_t));
+  if (!pool.deques || !threads || !args) {
+    free(pool.deques);
+    free(threads);
+    free(args);
+    return 1;
+  }
+  pthread_mutex_init(&pool.done_lock, NULL);
+  pthread_cond_init(&pool.done_cond, NULL);
+
+  /* Contiguous shares, so each worker mostly walks files in order */
+  for (int i = 0; i < worker_count; i++) {
+    pthread_mutex_init(&pool.deques[i].lock, NULL);
+    pool.deques[i].next = task_count * (size_t)i / (size_t)worker_count;
+    pool.deques[i].end = task_count * (size_t)(i + 1) / (size_t)worker_count;
+  }
 
-  char *line = NULL;
-  size_t line_cap = 0;
-  ssize_t line_len;
+  int started = 0;
+  for (int i = 0; i < worker_count; i++) {
+    args[i].pool = &pool;
+    args[i].id = i;
+    if (pthread_create(&threads[i], NULL, rg_worker, &args[i]) != 0) break;
+    started++;
+  }
+  if (started == 0) {
+    /* No threads: let this one drain every deque */
+    rg_worker_arg_t self = { .pool = &pool, .id = 0 };
+    rg_worker(&self);
+  }
 
-  while ((line_len = getline(&line, &line_cap, stdin)) != -1) {
-    /* Check for interrupt */
-    if (jbox_is_interrupted()) {
-      free(line);
-      line_buffer_free(&lines);
-      return -2;  /* Signal interruption */
+  int result = 0;
+  int interrupted = 0;
+  int remaining = opts->max_results;
+  for (size_t i = 0; i < task_count && !pool.stop; i++) {
+    rg_task_t *task = &tasks[i];
+    pthread_mutex_lock(&pool.done_lock);
+    while (!task->done) {
+      pthread_cond_wait(&pool.done_cond, &pool.done_lock);
     }
-
-    if (line_len > 0 && line[line_len - 1] == '\n') {
-      line[line_len - 1] = '\0';
+    pthread_mutex_unlock(&pool.done_lock);
+
+    if (opts->max_results > 0 && task->status != -2
+        && task->found > remaining) {
+      rg_options_t limited = *opts;
+      limited.max_count = remaining;
+      free(task->output);
+      task->output = NULL;
+      task->found = 0;
+      search_task(task, matcher, &limited);
     }
-    if (line_buffer_add(&lines, line) != 0) {
-      free(line);
-      line_buffer_free(&lines);
-      return 1;
+    if (opts->max_results > 0 && (remaining -= task->found) <= 0) {
+      atomic_store(&pool.stop, 1);
+    }
+
+    if (task->status == -2) interrupted = 1;
+    if (!interrupted) {
+      if (task->has_json && !*first_json_entry && !opts->json_stream) {
+        jbox_printf(",\n");
+      }
+      if (task->has_json) *first_json_entry = 0;
+      if (task->output_len > 0) {
+        fwrite(task->output, 1, task->output_len, jbox_stdout());
+        /* NDJSON readers act on each file's records as they arrive */
+        if (opts->json_stream) fflush(jbox_stdout());
+      }
+      if (task->status != 0) result = 1;
+      if (task->found) *found_any = 1;
     }
+    free(task->output);
+    task->output = NULL;
   }
-  free(line);
 
-  int *matched = calloc(lines.count, sizeof(int));
-  if (!matched) {
-    line_buffer_free(&lines);
-    return 1;
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
   }
+  for (int i = 0; i < worker_count; i++) {
+    pthread_mutex_destroy(&pool.deques[i].lock);
+  }
+  pthread_cond_destroy(&pool.done_cond);
+  pthread_mutex_destroy(&pool.done_lock);
+  free(pool.deques);
+  free(threads);
+  free(args);
+  return interrupted ? -2 : result;
+}
 
-  for (size_t i = 0; i < lines.count; i++) {
-    if (regexec(regex, lines.lines[i], 0, NULL, 0) == 0) {
-      matched[i] = 1;
-      *found_any = 1;
+
+/**
+ * Adds a file to the task list.
+ * @param tasks Task array, grown as needed
+ * @param count Number of tasks
+ * @param capacity Allocated size of the task array
+ * @param path Path to take ownership of
+ * @param skip_binary Whether the file was found by directory traversal
+ * @return 0 on success, -1 on allocation failure (path is freed)
+ */
+static int add_task(rg_task_t **tasks, size_t *count, size_t *capacity,
+                    char *path, int skip_binary) {
+  if (*count >= *capacity) {
+    size_t new_cap = *capacity == 0 ? 64 : *capacity * 2;
+    rg_task_t *grown = realloc(*tasks, new_cap * sizeof(rg_task_t));
+    if (!grown) {
+      free(path);
+      return -1;
     }
+    *tasks = grown;
+    *capacity = new_cap;
   }
+  rg_task_t *task = &(*tasks)[(*count)++];
+  memset(task, 0, sizeof(*task));
+  task->path = path;
+  task->skip_binary = skip_binary;
+  return 0;
+}
 
-  int last_printed = -1;
-  int need_separator = 0;
 
-  for (size_t i = 0; i < lines.count; i++) {
-    if (!matched[i]) continue;
+/**
+ * Builds the list of files to search from the command line, expanding
+ * directories recursively.
+ *
+ * With --indexed, a directory covered by a trigram index is expanded to
+ * the files the index says may contain a pattern's literal, without
+ * walking it; a directory with no index is walked as usual.
+ *
+ * @param files File and directory arguments
+ * @param file_count Number of arguments
+ * @param patterns Patterns searched for
+ * @param indexed Whether to use trigram indexes
+ * @param tasks Set to the task array
+ * @param task_count Set to the number of tasks
+ * @return 0 on success, -1 on allocation failure, -2 on interrupt
+ */
+static int collect_tasks(const char **files, int file_count,
+                         const rg_patterns_t *patterns, int indexed,
+                         rg_task_t **tasks, size_t *task_count) {
+  size_t capacity = 0;
+  *tasks = NULL;
+  *task_count = 0;
+
+  for (int i = 0; i < file_count; i++) {
+    struct stat st;
+    if (stat(files[i], &st) != 0 || !S_ISDIR(st.st_mode)) {
+      char *path = strdup(files[i]);
+      if (!path || add_task(tasks, task_count, &capacity, path, 0) != 0) {
+        return -1;
+      }
+      continue;
+    }
 
-    if (show_json) {
-      match_result_t match = {
-        .file = "(stdin)",
-        .line = (int)(i + 1),
-        .column = find_column(lines.lines[i], regex),
-        .text = lines.lines[i]
-      };
-      print_match_json(&match, first_json_entry);
+    rg_file_list_t list;
+    rg_file_list_init(&list);
+    rg_index_t *index = indexed ? rg_index_open(files[i]) : NULL;
+    int rc;
+    if (index) {
+      rc = rg_index_candidates(index, files[i], patterns->literals,
+                               patterns->literals ? patterns->count : 0,
+                               &list);
+      rg_index_close(index);
     } else {
-      if (context_lines > 0) {
-        int ctx_start = (int)i - context_lines;
-        if (ctx_start < 0) ctx_start = 0;
-        int ctx_end = (int)i + context_lines;
-        if (ctx_end >= (int)lines.count) ctx_end = (int)lines.count - 1;
-
-        if (need_separator && ctx_start > last_printed + 1) {
-          printf("--\n");
-        }
-
-        for (int j = ctx_start; j <= ctx_end; j++) {
-          if (j <= last_printed) continue;
-
-          if (matched[j]) {
-            print_context_line("(stdin)", j + 1, lines.lines[j], 0,
-                               show_line_numbers, ':');
-          } else {
-            print_context_line("(stdin)", j + 1, lines.lines[j], 0,
-                               show_line_numbers, '-');
-          }
-          last_printed = j;
-        }
-        need_separator = 1;
-      } else {
-        match_result_t match = {
-          .file = "(stdin)",
-          .line = (int)(i + 1),
-          .column = find_column(lines.lines[i], regex),
-          .text = lines.lines[i]
-        };
-        print_match_text(&match, 0, show_line_numbers);
+      rc = rg_walk_collect(files[i], &list);
+    }
+    for (size_t j = 0; j < list.count; j++) {
+      if (rc == 0
+          && add_task(tasks, task_count, &capacity, list.paths[j], 1) != 0) {
+        rc = -1;
+      } else if (rc != 0) {
+        free(list.paths[j]);
       }
+      list.paths[j] = NULL;
+    }
+    rg_file_list_free(&list);
+    if (rc != 0) return rc;
+  }
+  return 0;
+}
+
+
+/**
+ * Frees a task list.
+ * @param tasks Task array
+ * @param task_count Number of tasks
+ */
+static void free_tasks(rg_task_t *tasks, size_t task_count) {
+  for (size_t i = 0; i < task_count; i++) {
+    free(tasks[i].path);
+    free(tasks[i].output);
+  }
+  free(tasks);
+}
+
+
+/**
+ * Builds or updates the trigram index of each directory given.
+ * @param dirs Directories
+ * @param count Number of directories
+ * @param show_json Whether to report in JSON
+ * @param json_stream Whether to report as NDJSON
+ * @return 0 on success, 1 if any index could not be built, 130 on
+ *         interrupt
+ */
+static int build_indexes(const char **dirs, int count, int show_json,
+                         int json_stream) {
+  int result = 0;
+  if (show_json && !json_stream) jbox_printf("[\n");
+  for (int i = 0; i < count; i++) {
+    rg_index_stats_t stats;
+    int rc = rg_index_build(dirs[i], &stats);
+    if (rc == -2) {
+      result = 130;
+      break;
+    }
+    if (rc != 0) {
+      fprintf(stderr, "rg: %s: %s\n", dirs[i], strerror(errno));
+      result = 1;
+      continue;
+    }
+    if (show_json) {
+      if (i > 0 && !json_stream) jbox_printf(",\n");
+      jbox_printf("{\"dir\": ");
+      jbox_json_write_string(jbox_stdout(), dirs[i]);
+      jbox_printf(", \"files\": %zu, \"read\": %zu, \"trigrams\": %zu}%s",
+                  stats.files, stats.read, stats.trigrams,
+                  json_stream ? "\n" : "");
+    } else {
+      jbox_printf("%s: indexed %zu files (%zu read), %zu trigrams\n",
+                  dirs[i], stats.files, stats.read, stats.trigrams);
     }
   }
+  if (show_json && !json_stream) jbox_printf("\n]\n");
+  return result;
+}
+
+
+/**
+ * Parses a --max-filesize: bytes, with an optional K, M or G suffix.
+ * @param text Text to parse
+ * @param bytes Set to the size
+ * @return 0 on success, -1 if text is not a size
+ */
+static int parse_filesize(const char *text, off_t *bytes) {
+  char *end;
+  errno = 0;
+  unsigned long long value = strtoull(text, &end, 10);
+  if (errno != 0 || end == text || *text == '-') {
+    return -1;
+  }
+
+  unsigned int shift = 0;
+  switch (toupper((unsigned char)*end)) {
+    case 'K': shift = 10; end++; break;
+    case 'M': shift = 20; end++; break;
+    case 'G': shift = 30; end++; break;
+    default: break;
+  }
+  if (*end != '\0' || value > ((unsigned long long)INT64_MAX >> shift)) {
+    return -1;
+  }
 
-  free(matched);
-  line_buffer_free(&lines);
+  *bytes = (off_t)(value << shift);
   return 0;
 }
 
@@ -578,7 +1347,7 @@ static int rg_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    rg_print_usage(stdout);
+    rg_print_usage(jbox_stdout());
     cleanup_rg_argtable(&args);
     return 0;
   }
@@ -590,116 +1359,200 @@ static int rg_run(int argc, char **argv) {
     return 1;
   }
 
-  int show_json = args.json->count > 0;
+  int json_stream = args.json_stream->count > 0;
+  int show_json = args.json->count > 0 || json_stream;
+
+  /* With --index, -e or -f, what argtable took as PATTERN is a FILE */
+  int pattern_given = args.index->count == 0 && args.regexp->count == 0
+                      && args.pattern_file->count == 0;
+  if (pattern_given && args.pattern->count == 0) {
+    fprintf(stderr, "rg: no pattern given\n");
+    fprintf(stderr, "Try 'rg --help' for more information.\n");
+    cleanup_rg_argtable(&args);
+    return 1;
+  }
+  const char **files = malloc((size_t)(args.files->count + 1)
+                              * sizeof(char *));
+  if (!files) {
+    fprintf(stderr, "rg: memory allocation failed\n");
+    cleanup_rg_argtable(&args);
+    return 1;
+  }
+  int file_count = 0;
+  if (!pattern_given && args.pattern->count > 0) {
+    files[file_count++] = args.pattern->sval[0];
+  }
+  for (int i = 0; i < args.files->count; i++) {
+    files[file_count++] = args.files->filename[i];
+  }
+
+  /* An index is of a directory: the current one by default */
+  static const char *current_dir[] = { "." };
+
+  if (args.index->count > 0) {
+    int rc = 1;
+    if (strcmp(args.index->sval[0], "build") != 0) {
+      fprintf(stderr, "rg: unknown index action '%s' (expected 'build')\n",
+              args.index->sval[0]);
+    } else if (file_count == 0) {
+      rc = build_indexes(current_dir, 1, show_json, json_stream);
+    } else {
+      rc = build_indexes(files, file_count, show_json, json_stream);
+    }
+    free(files);
+    cleanup_rg_argtable(&args);
+    return rc;
+  }
+
   int show_line_numbers = args.line_numbers->count > 0;
   int ignore_case = args.ignore_case->count > 0;
   int word_match = args.word_match->count > 0;
   int fixed_strings = args.fixed_strings->count > 0;
   int context_lines = args.context->count > 0 ? args.context->ival[0] : 0;
-  const char *pattern = args.pattern->sval[0];
-  int file_count = args.files->count;
-
-  char *search_pattern = NULL;
-
-  if (fixed_strings) {
-    search_pattern = escape_regex_pattern(pattern);
-    if (!search_pattern) {
-      fprintf(stderr, "rg: memory allocation failed\n");
-      cleanup_rg_argtable(&args);
-      return 1;
-    }
-  } else {
-    search_pattern = strdup(pattern);
-    if (!search_pattern) {
-      fprintf(stderr, "rg: memory allocation failed\n");
-      cleanup_rg_argtable(&args);
-      return 1;
-    }
+  int max_count = args.max_count->count > 0 ? args.max_count->ival[0] : 0;
+  int max_results = args.max_results->count > 0
+                    ? args.max_results->ival[0] : 0;
+  off_t max_filesize = 0;
+  if (max_results < 0 || (args.max_results->count > 0 && max_results == 0)) {
+    fprintf(stderr, "rg: invalid --max-results '%d'\n", max_results);
+    free(files);
+    cleanup_rg_argtable(&args);
+    return 1;
+  }
+  if (args.max_filesize->count > 0
+      && parse_filesize(args.max_filesize->sval[0], &max_filesize) != 0) {
+    fprintf(stderr, "rg: invalid --max-filesize '%s'\n",
+            args.max_filesize->sval[0]);
+    free(files);
+    cleanup_rg_argtable(&args);
+    return 1;
+  }
+  /* No one file can give more results than there are in all */
+  if (max_results > 0 && (max_count == 0 || max_count > max_results)) {
+    max_count = max_results;
+  }
+  int indexed = args.indexed->count > 0;
+  const char **search_files = files;
+  if (indexed && file_count == 0) {
+    search_files = current_dir;
+    file_count = 1;
   }
 
-  if (word_match) {
-    char *word_pat = create_word_pattern(search_pattern);
-    free(search_pattern);
-    if (!word_pat) {
-      fprintf(stderr, "rg: memory allocation failed\n");
-      cleanup_rg_argtable(&args);
-      return 1;
+  /* PATTERN or the -e patterns, then each line of each -f file */
+  rg_patterns_t patterns;
+  rg_patterns_init(&patterns);
+  int ok = !pattern_given
+           || rg_patterns_add(&patterns, args.pattern->sval[0]) == 0;
+  for (int i = 0; i < args.regexp->count && ok; i++) {
+    ok = rg_patterns_add(&patterns, args.regexp->sval[i]) == 0;
+  }
+  if (!ok) {
+    fprintf(stderr, "rg: memory allocation failed\n");
+  }
+  for (int i = 0; i < args.pattern_file->count && ok; i++) {
+    if (rg_patterns_add_file(&patterns,
+                             args.pattern_file->filename[i]) != 0) {
+      fprintf(stderr, "rg: %s: %s\n", args.pattern_file->filename[i],
+              strerror(errno));
+      ok = 0;
     }
-    search_pattern = word_pat;
   }
-
-  int cflags = REG_EXTENDED | REG_NEWLINE;
-  if (ignore_case) {
-    cflags |= REG_ICASE;
+  if (ok && rg_patterns_prepare(&patterns, fixed_strings, ignore_case,
+                                word_match) != 0) {
+    fprintf(stderr, "rg: memory allocation failed\n");
+    ok = 0;
   }
 
-  regex_t regex;
-  int regex_err = regcomp(&regex, search_pattern, cflags);
-  free(search_pattern);
-
-  if (regex_err != 0) {
-    char err_buf[256];
-    regerror(regex_err, &regex, err_buf, sizeof(err_buf));
+  rg_matcher_t matcher;
+  char err_buf[256];
+  if (ok && rg_matcher_init(&matcher, &patterns, err_buf,
+                            sizeof(err_buf)) != 0) {
     fprintf(stderr, "rg: invalid pattern: %s\n", err_buf);
+    ok = 0;
+  }
+  if (!ok) {
+    rg_patterns_free(&patterns);
+    free(files);
     cleanup_rg_argtable(&args);
     return 1;
   }
 
+  rg_options_t opts = {
+    .show_json = show_json,
+    .json_stream = json_stream,
+    .show_line_numbers = show_line_numbers,
+    .show_filename = file_count > 1,
+    .context_lines = context_lines,
+    .max_count = max_count,
+    .max_results = max_results,
+    .max_filesize = max_filesize,
+    .only_matching = args.only_matching->count > 0,
+    .count = args.count->count > 0,
+    .files_with_matches = args.files_with_matches->count > 0,
+    .search_zip = args.search_zip->count > 0,
+    .patterns = &patterns,
+  };
+
+  for (int i = 0; i < file_count; i++) {
+    struct stat st;
+    if (stat(search_files[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+      opts.show_filename = 1;
+    }
+  }
+
   int first_json_entry = 1;
   int result = 0;
   int found_any = 0;
-  int show_filename = file_count > 1;
+  int search_result = 0;
 
-  if (show_json) {
-    printf("[\n");
+  if (json_stream) {
+    /* A host owns its stream's buffering, and this buffer is shared */
+    if (!jbox_ctx_is_hosted()) {
+      setvbuf(jbox_stdout(), rg_stream_buffer, _IOFBF,
+              sizeof(rg_stream_buffer));
+    }
+  } else if (show_json) {
+    jbox_printf("[\n");
   }
 
   if (file_count == 0) {
-    int search_result = search_stdin(&regex, show_json, show_line_numbers,
-                                     context_lines, &first_json_entry,
-                                     &found_any);
-    if (search_result == -2) {
-      if (show_json) printf("\n]\n");
-      regfree(&regex);
-      cleanup_rg_argtable(&args);
-      return 130;  /* 128 + SIGINT(2) */
-    }
-    if (search_result != 0) {
-      result = 1;
-    }
+    search_result = search_stdin(&matcher, &opts, &first_json_entry,
+                                 &found_any);
   } else {
-    for (int i = 0; i < file_count; i++) {
-      /* Check for interrupt between files */
-      if (jbox_is_interrupted()) {
-        if (show_json) printf("\n]\n");
-        regfree(&regex);
-        cleanup_rg_argtable(&args);
-        return 130;  /* 128 + SIGINT(2) */
-      }
-
-      int search_result = search_file(args.files->filename[i], &regex,
-                                      show_json, show_line_numbers,
-                                      show_filename, context_lines,
+    rg_task_t *tasks;
+    size_t task_count;
+    search_result = collect_tasks(search_files, file_count, &patterns,
+                                  indexed, &tasks, &task_count);
+    if (search_result == -1) {
+      fprintf(stderr, "rg: memory allocation failed\n");
+      search_result = 1;
+    } else if (search_result == 0 && task_count == 1) {
+      /* A single file streams straight to stdout */
+      search_result = search_file(tasks[0].path, &matcher, &opts,
+                                  tasks[0].skip_binary, jbox_stdout(),
+                                  &first_json_entry, &found_any);
+    } else if (search_result == 0 && task_count > 1) {
+      search_result = search_parallel(tasks, task_count, &matcher, &opts,
                                       &first_json_entry, &found_any);
-      if (search_result == -2) {
-        if (show_json) printf("\n]\n");
-        regfree(&regex);
-        cleanup_rg_argtable(&args);
-        return 130;  /* 128 + SIGINT(2) */
-      }
-      if (search_result != 0) {
-        result = 1;
-      }
     }
+    free_tasks(tasks, task_count);
   }
 
-  if (show_json) {
-    printf("\n]\n");
+  if (show_json && !json_stream) {
+    jbox_printf("\n]\n");
   }
 
-  regfree(&regex);
+  rg_matcher_free(&matcher);
+  rg_patterns_free(&patterns);
+  free(files);
   cleanup_rg_argtable(&args);
 
+  if (search_result == -2) {
+    return 130;  /* 128 + SIGINT(2) */
+  }
+  if (search_result != 0) {
+    result = 1;
+  }
   if (result != 0) return result;
   return found_any ? 0 : 1;
 }
@@ -711,10 +1564,34 @@ const jshell_cmd_spec_t cmd_rg_spec = {
   .summary = "search for patterns using regular expressions",
   .long_help = "Search for PATTERN in each FILE or standard input. "
                "PATTERN is a POSIX extended regular expression by default. "
-               "Use --fixed-strings to treat PATTERN as a literal string.",
+               "Use --fixed-strings to treat PATTERN as a literal string. "
+               "-e PATTERN, repeated, and -f FILE, one pattern per line, "
+               "search for several patterns in one pass: literal ones are "
+               "found together by an Aho-Corasick automaton and the rest "
+               "run as one combined DFA, and JSON entries say which "
+               "pattern matched. "
+               "-o prints each match, -c counts matching lines and -l "
+               "lists files with a match, reading each only up to its "
+               "first hit. -m NUM stops reading a file after NUM matching "
+               "lines and --max-results NUM stops the whole search after "
+               "NUM, keeping the first in path order; --max-filesize SIZE "
+               "skips larger files without reading them. --json-stream "
+               "writes one JSON object per line, "
+               "flushed as each file finishes, for readers that act on "
+               "results as they arrive. -z searches gzip and zstd "
+               "compressed files as the text they hold, decompressing each "
+               "on its own thread while it is searched. "
+               "rg --index build DIR keeps a trigram index of DIR in "
+               "~/.jshell/cache, rereading only files changed since the "
+               "last build, and --indexed searches only the files it says "
+               "may match. "
+               "Directories are searched recursively on all cores, skipping "
+               ".git, files matched by .gitignore and binary files.",
   .type = CMD_EXTERNAL,
   .run = rg_run,
-  .print_usage = rg_print_usage
+  .print_usage = rg_print_usage,
+  .describe_args = rg_describe_args,
+  .cache_scope = rg_cache_scope
 };
 
 
@@ -0,0 +1,312 @@
+/** @file rg_decompress.c
+ *  @brief Streaming gzip and zstd decompression for rg -z
+ *
+ *  Each compressed input gets a thread that reads it, inflates it and
+ *  writes the text into a socket pair; the searching thread reads the
+ *  other end like any file. The socket's buffer lets the decompressor
+ *  run ahead of the search by a few hundred KiB, so the two overlap on
+ *  separate cores, and with several files searched at once each has its
+ *  own decompressor. Sockets rather than a pipe, so that a search which
+ *  stops early makes the decompressor's next send fail with EPIPE
+ *  (MSG_NOSIGNAL) instead of raising SIGPIPE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <zstd.h>
+
+#include "rg_decompress.h"
+
+
+/** Bytes read from the input, and written to the socket, at a time */
+#define RG_DECOMPRESS_CHUNK (128 * 1024)
+
+/** Bytes the socket buffers between decompressor and search */
+#define RG_DECOMPRESS_BUFFER (512 * 1024)
+
+
+typedef enum {
+  RG_FORMAT_PLAIN,      /* Copied through: input that cannot be rewound */
+  RG_FORMAT_GZIP,
+  RG_FORMAT_ZSTD
+} rg_format_t;
+
+
+struct rg_decompress {
+  int in_fd;
+  int write_fd;         /* Decompressor's end, closed by the thread */
+  int read_fd;          /* Search's end */
+  bool regular;         /* Input is a regular file; reads never block */
+  rg_format_t format;
+  unsigned char prefix[4];
+  size_t prefix_len;    /* Bytes read to tell the format */
+  pthread_t thread;
+  const char *error;    /* Set by the thread, read after joining */
+  int error_num;        /* errno of a read error, when error is NULL */
+};
+
+
+/**
+ * Reads up to len bytes, retrying short reads.
+ * @param fd Descriptor to read
+ * @param buf Buffer
+ * @param len Bytes wanted
+ * @return Bytes read (less than len only at end of input), -1 on error
+ */
+static ssize_t read_full(int fd, void *buf, size_t len) {
+  size_t got = 0;
+  while (got < len) {
+    ssize_t n = read(fd, (char *)buf + got, len - got);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) return -1;
+    if (n == 0) break;
+    got += (size_t)n;
+  }
+  return (ssize_t)got;
+}
+
+
+/**
+ * Tells the format of an input from its first bytes.
+ * @param p First bytes
+ * @param len Number of bytes (at most 4)
+ * @return Format, RG_FORMAT_PLAIN if neither gzip nor zstd
+ */
+static rg_format_t detect_format(const unsigned char *p, size_t len) {
+  if (len >= 2 && p[0] == 0x1f && p[1] == 0x8b) return RG_FORMAT_GZIP;
+  if (len == 4) {
+    unsigned long magic = (unsigned long)p[0] | (unsigned long)p[1] << 8
+                          | (unsigned long)p[2] << 16
+                          | (unsigned long)p[3] << 24;
+    /* A frame, or the skippable frame compress -z writes before one */
+    if (magic == 0xFD2FB528ul || (magic & 0xFFFFFFF0ul) == 0x184D2A50ul) {
+      return RG_FORMAT_ZSTD;
+    }
+  }
+  return RG_FORMAT_PLAIN;
+}
+
+
+/**
+ * Waits until the input can be read without blocking or the search has
+ * gone, so a search of a pipe that stops early is not held up by a
+ * writer that sends nothing more.
+ * @param dec Decompressor
+ * @return true to read on, false if the search has gone
+ */
+static bool wait_input(rg_decompress_t *dec) {
+  if (dec->regular) return true;
+  struct pollfd fds[2] = {
+    { .fd = dec->in_fd, .events = POLLIN },
+    { .fd = dec->write_fd, .events = 0 }
+  };
+  for (;;) {
+    int n = poll(fds, 2, -1);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) return true;             /* Let the read report it */
+    if (fds[1].revents & (POLLHUP | POLLERR)) return false;
+    if (fds[0].revents) return true;
+  }
+}
+
+
+/**
+ * Writes decompressed text to the search.
+ * @param dec Decompressor
+ * @param data Text
+ * @param len Length of text
+ * @return 0 on success, -1 if the search has stopped reading
+ */
+static int send_all(rg_decompress_t *dec, const unsigned char *data,
+                    size_t len) {
+  while (len > 0) {
+    ssize_t n = send(dec->write_fd, data, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) return -1;
+    data += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+
+/**
+ * Decompressor thread: inflates the input into the socket until the end
+ * of the input or until the search stops reading.
+ * @param arg rg_decompress_t
+ * @return NULL
+ */
+static void *decompress_thread(void *arg) {
+  rg_decompress_t *dec = arg;
+  unsigned char *ibuf = malloc(RG_DECOMPRESS_CHUNK);
+  unsigned char *obuf = malloc(RG_DECOMPRESS_CHUNK);
+  z_stream z = {0};
+  bool z_ready = false;
+  ZSTD_DCtx *dctx = NULL;
+
+  if (!ibuf || !obuf) {
+    dec->error = "out of memory";
+  } else if (dec->format == RG_FORMAT_GZIP) {
+    z_ready = inflateInit2(&z, 16 + MAX_WBITS) == Z_OK;
+    if (!z_ready) dec->error = "out of memory";
+  } else if (dec->format == RG_FORMAT_ZSTD) {
+    dctx = ZSTD_createDCtx();
+    if (!dctx) dec->error = "out of memory";
+  }
+
+  const unsigned char *data = dec->prefix;
+  size_t len = dec->prefix_len;
+  bool at_end = false;      /* The last member or frame ended */
+  while (!dec->error) {
+    if (len == 0) {
+      if (!wait_input(dec)) break;
+      ssize_t n = read(dec->in_fd, ibuf, RG_DECOMPRESS_CHUNK);
+      if (n < 0 && errno == EINTR) continue;
+      if (n < 0) {
+        dec->error_num = errno;
+        break;
+      }
+      if (n == 0) {
+        if (!at_end && dec->format != RG_FORMAT_PLAIN) {
+          dec->error = "unexpected end of compressed data";
+        }
+        break;
+      }
+      data = ibuf;
+      len = (size_t)n;
+    }
+
+    const unsigned char *out = obuf;
+    size_t used, produced;
+    if (dec->format == RG_FORMAT_PLAIN) {
+      out = data;
+      used = produced = len;
+    } else if (dec->format == RG_FORMAT_GZIP) {
+      /* Concatenated members, as compress and pigz write, are one file */
+      if (at_end) inflateReset(&z);
+      z.next_in = (Bytef *)data;
+      z.avail_in = (uInt)len;
+      z.next_out = obuf;
+      z.avail_out = RG_DECOMPRESS_CHUNK;
+      int zrc = inflate(&z, Z_NO_FLUSH);
+      if (zrc != Z_OK && zrc != Z_STREAM_END && zrc != Z_BUF_ERROR) {
+        dec->error = "invalid compressed data";
+        break;
+      }
+      at_end = zrc == Z_STREAM_END;
+      used = len - z.avail_in;
+      produced = RG_DECOMPRESS_CHUNK - z.avail_out;
+    } else {
+      ZSTD_inBuffer zin = { data, len, 0 };
+      ZSTD_outBuffer zout = { obuf, RG_DECOMPRESS_CHUNK, 0 };
+      size_t zrc = ZSTD_decompressStream(dctx, &zout, &zin);
+      if (ZSTD_isError(zrc)) {
+        dec->error = "invalid compressed data";
+        break;
+      }
+      at_end = zrc == 0;
+      used = zin.pos;
+      produced = zout.pos;
+    }
+    data += used;
+    len -= used;
+
+    if (produced > 0 && send_all(dec, out, produced) != 0) {
+      break;                /* The search has what it wanted */
+    }
+  }
+
+  /* End of file for the search */
+  close(dec->write_fd);
+  dec->write_fd = -1;
+  if (z_ready) inflateEnd(&z);
+  ZSTD_freeDCtx(dctx);
+  free(ibuf);
+  free(obuf);
+  return NULL;
+}
+
+
+/**
+ * Starts decompressing an input if it is compressed.
+ * @param fd Input descriptor
+ * @param search_fd Set to the descriptor to search
+ * @param dec Set to the decompressor, or NULL if none was started
+ * @return 0 on success, -1 on error (errno set)
+ */
+int rg_decompress_start(int fd, int *search_fd, rg_decompress_t **dec) {
+  *dec = NULL;
+  *search_fd = fd;
+
+  unsigned char prefix[4];
+  ssize_t n = read_full(fd, prefix, sizeof(prefix));
+  if (n < 0) return -1;
+  rg_format_t format = detect_format(prefix, (size_t)n);
+  if (format == RG_FORMAT_PLAIN && lseek(fd, 0, SEEK_SET) == 0) {
+    return 0;
+  }
+
+  rg_decompress_t *d = calloc(1, sizeof(*d));
+  if (!d) return -1;
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) {
+    free(d);
+    return -1;
+  }
+  int size = RG_DECOMPRESS_BUFFER;
+  setsockopt(sv[1], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+  /* The search only reads, the decompressor only writes */
+  shutdown(sv[0], SHUT_WR);
+  shutdown(sv[1], SHUT_RD);
+
+  struct stat st;
+  d->in_fd = fd;
+  d->read_fd = sv[0];
+  d->write_fd = sv[1];
+  d->regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+  d->format = format;
+  memcpy(d->prefix, prefix, (size_t)n);
+  d->prefix_len = (size_t)n;
+
+  int err = pthread_create(&d->thread, NULL, decompress_thread, d);
+  if (err != 0) {
+    close(sv[0]);
+    close(sv[1]);
+    free(d);
+    errno = err;
+    return -1;
+  }
+  *search_fd = d->read_fd;
+  *dec = d;
+  return 0;
+}
+
+
+/**
+ * Stops a decompressor and reports how it ended.
+ * @param dec Decompressor, or NULL
+ * @return NULL on success, or why the input could not be decompressed
+ */
+const char *rg_decompress_finish(rg_decompress_t *dec) {
+  if (!dec) return NULL;
+
+  /* Ends the thread's next send if the search stopped early */
+  close(dec->read_fd);
+  pthread_join(dec->thread, NULL);
+
+  const char *error = dec->error;
+  if (!error && dec->error_num != 0) error = strerror(dec->error_num);
+  free(dec);
+  return error;
+}
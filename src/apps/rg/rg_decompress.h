@@ -0,0 +1,28 @@
+#ifndef RG_DECOMPRESS_H
+#define RG_DECOMPRESS_H
+
+// Transparent decompression of gzip and zstd input (-z)
+//
+// A compressed input is inflated on a thread of its own into one end of
+// a socket pair, and the search reads plain text from the other end, so
+// decompressing the next chunk overlaps matching the last one. The
+// format is told by the input's first bytes, not its name; other input
+// is searched as it is.
+typedef struct rg_decompress rg_decompress_t;
+
+// Start decompressing fd if it holds gzip or zstd data. *search_fd is
+// set to the descriptor to search: fd itself if it is not compressed (it
+// is then rewound, or fed through the thread if it cannot be), or the
+// read end of the stream. fd must stay open until rg_decompress_finish.
+// Returns 0 on success (*dec set, NULL when nothing was started), -1 on
+// error (errno set)
+int rg_decompress_start(int fd, int *search_fd, rg_decompress_t **dec);
+
+// Stop reading, wait for the thread and free dec, which may be NULL.
+// The search may stop before the end of the input (-l, -m); the rest of
+// it is not decompressed.
+// Returns NULL on success, or a message saying why the input could not
+// be decompressed in full
+const char *rg_decompress_finish(rg_decompress_t *dec);
+
+#endif /* RG_DECOMPRESS_H */
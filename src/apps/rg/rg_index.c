@@ -0,0 +1,1405 @@
+/** @file rg_index.c
+ *  @brief Persistent trigram index of a directory tree for rg --indexed
+ *
+ *  An .rgix file is a fixed header followed by four sections: the file
+ *  table (device, inode, size, mtime, trigram count and path of each
+ *  file, in walk order), the strings (the indexed root, then every
+ *  file's path relative to it), the posting lists (ascending file
+ *  numbers as LEB128 deltas) and the trigram table (each trigram with
+ *  the size and offset of its posting list, ascending by trigram).
+ *  Searching maps the file and binary-searches the trigram table, so the
+ *  cost does not depend on the size of the tree, only on the posting
+ *  lists read.
+ *
+ *  Building walks the tree as rg does, then reads the files on a pool of
+ *  threads, each with a bitmap of the 2^24 trigrams to collect a file's
+ *  distinct ones. A file whose stat matches its entry in the old index
+ *  is not read; its trigrams are taken from the old posting lists. Files
+ *  are taken in batches of at most INDEX_BATCH_PAIRS (trigram, file)
+ *  pairs, each radix sorted into a run of posting lists in a temporary
+ *  file, and the runs are merged trigram by trigram into the index, so
+ *  memory stays bounded however large the tree. The index is written to
+ *  a temporary name and renamed into place.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rg_index.h"
+#include "utils/jbox_ctx.h"
+#include "utils/jbox_signals.h"
+#include "utils/jbox_walk.h"
+
+
+#define INDEX_MAGIC "RGIX"
+
+/** Bump whenever the file layout changes */
+#define INDEX_FORMAT 1
+
+/** Bytes read from a file at a time while building */
+#define INDEX_CHUNK (256 * 1024)
+
+/** Leading bytes checked for a NUL, as rg does before searching a file */
+#define INDEX_BINARY_PROBE (64 * 1024)
+
+/** Upper bound on reading threads, whatever the core count */
+#define INDEX_MAX_WORKERS 64
+
+/** Number of distinct trigrams */
+#define TRIGRAM_SPACE (1u << 24)
+
+/** Pairs sorted at once: 128 MiB, and as much again to sort them */
+#define INDEX_BATCH_PAIRS (16u * 1024 * 1024)
+
+/** mtime_nsec of an entry whose file could not be read, so the next
+ *  build reads it again */
+#define INDEX_UNREAD (-1)
+
+
+typedef struct {
+  char magic[4];
+  uint32_t format;
+  uint64_t file_count;
+  uint64_t trigram_count;
+  uint64_t root_len;            /* Root path, first in the strings */
+  uint64_t files_off;
+  uint64_t strings_off;
+  uint64_t strings_len;
+  uint64_t postings_off;
+  uint64_t postings_len;
+  uint64_t trigrams_off;
+} index_header_t;
+
+typedef struct {
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint64_t path_off;            /* In the strings, relative to the root */
+  uint32_t path_len;
+  uint32_t trigram_count;       /* Distinct trigrams in the file */
+} index_file_t;
+
+typedef struct {
+  uint32_t trigram;
+  uint32_t count;               /* Files in the posting list */
+  uint64_t offset;              /* In the postings */
+} index_trigram_t;
+
+struct rg_index {
+  void *map;
+  size_t map_len;
+  const index_header_t *header;
+  const index_file_t *files;
+  const index_trigram_t *trigrams;
+  const char *strings;
+  const unsigned char *postings;
+  char *sub;                    /* Searched directory below the root,
+                                 * "" or ending in '/' */
+};
+
+
+/** A file found while building */
+typedef struct {
+  char *path;                   /* As walked, starting with the root */
+  struct stat st;
+  int ok;                       /* In the index: stat succeeded */
+  int unread;                   /* Could not be read; has no trigrams */
+  long old_id;                  /* Unchanged entry of the old index, or -1 */
+  uint32_t *trigrams;           /* Distinct trigrams, once read */
+  size_t trigram_count;
+} build_file_t;
+
+/** A range of files shared by the threads statting or reading them */
+typedef struct {
+  build_file_t *files;
+  size_t next;                  /* Guarded by lock */
+  size_t end;
+  int stat_only;                /* Stat the files rather than read them */
+  int failed;                   /* Out of memory, guarded by lock */
+  pthread_mutex_t lock;
+  jbox_ctx_t *ctx;
+  const rg_index_t *old;
+} build_pool_t;
+
+/** (trigram << 32 | file) pairs */
+typedef struct {
+  uint64_t *items;
+  size_t count;
+  size_t cap;
+} pair_list_t;
+
+/** Sorted posting lists of one batch, in the run file */
+typedef struct {
+  uint64_t postings_off;
+  uint64_t trigrams_off;
+  uint64_t trigram_count;
+} run_t;
+
+/** Where the merge is in the old lists, so each batch takes on from there */
+typedef struct {
+  uint64_t pos;                 /* Offset of the next varint */
+  uint32_t done;                /* File numbers taken so far */
+  uint32_t next;                /* The next file number, if done < count */
+} old_cursor_t;
+
+
+/**
+ * Gets the user's home directory.
+ * @return Home directory, or NULL if not found
+ */
+static const char *home_directory(void) {
+  const char *home = getenv("HOME");
+  if (home != NULL && home[0] != '\0') {
+    return home;
+  }
+
+  struct passwd *pw = getpwuid(getuid());
+  if (pw != NULL && pw->pw_dir != NULL) {
+    return pw->pw_dir;
+  }
+
+  return NULL;
+}
+
+
+/**
+ * Hashes bytes with FNV-1a.
+ * @param data Bytes to hash
+ * @param len Number of bytes
+ * @return Hash
+ */
+static uint64_t fnv1a(const void *data, size_t len) {
+  const unsigned char *p = data;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= p[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+
+/**
+ * Builds the path of a directory's index.
+ * @param root Indexed directory, absolute with symlinks resolved
+ * @param path Set to the index path
+ * @param create Whether to make the cache directory if needed
+ * @return 0 on success, -1 if there is no usable cache directory
+ */
+static int index_path(const char *root, char path[PATH_MAX], int create) {
+  const char *home = home_directory();
+  if (home == NULL) {
+    return -1;
+  }
+
+  if (create) {
+    snprintf(path, PATH_MAX, "%s/.jshell", home);
+    if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+      return -1;
+    }
+    snprintf(path, PATH_MAX, "%s%s", home, RG_INDEX_SUBPATH);
+    if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+      return -1;
+    }
+  }
+  int n = snprintf(path, PATH_MAX, "%s%s/%016llx.rgix", home,
+                   RG_INDEX_SUBPATH,
+                   (unsigned long long)fnv1a(root, strlen(root)));
+  return n < PATH_MAX ? 0 : -1;
+}
+
+
+/**
+ * ASCII lower-casing, so one index serves case-sensitive and -i searches.
+ * @param c Byte
+ * @return Lower-case byte
+ */
+static unsigned char fold(unsigned char c) {
+  return (c >= 'A' && c <= 'Z') ? (unsigned char)(c + ('a' - 'A')) : c;
+}
+
+
+/**
+ * Reads a LEB128 number.
+ * @param p Bytes
+ * @param len Number of bytes
+ * @param pos Offset of the number, advanced past it
+ * @param value Set to the number
+ * @return 0 on success, -1 if it runs past the end or is too long
+ */
+static int get_varint(const unsigned char *p, size_t len, size_t *pos,
+                      uint64_t *value) {
+  uint64_t v = 0;
+  for (int shift = 0; shift <= 35; shift += 7) {
+    if (*pos >= len) return -1;
+    unsigned char b = p[(*pos)++];
+    v |= (uint64_t)(b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+      *value = v;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+
+/**
+ * Appends a LEB128 number to a byte buffer.
+ * @param buf Buffer, grown as needed
+ * @param len Bytes used
+ * @param cap Allocated size
+ * @param value Number
+ * @return 0 on success, -1 if out of memory
+ */
+static int put_varint(unsigned char **buf, size_t *len, size_t *cap,
+                      uint64_t value) {
+  if (*cap - *len < 10) {
+    size_t new_cap = *cap == 0 ? 65536 : *cap * 2;
+    unsigned char *grown = realloc(*buf, new_cap);
+    if (!grown) return -1;
+    *buf = grown;
+    *cap = new_cap;
+  }
+  do {
+    unsigned char b = value & 0x7f;
+    value >>= 7;
+    (*buf)[(*len)++] = value ? (unsigned char)(b | 0x80) : b;
+  } while (value);
+  return 0;
+}
+
+
+/**
+ * Maps an index file and checks its layout.
+ * @param path Index file
+ * @param root Directory the index must be of
+ * @return Index (sub unset), or NULL if missing, of another directory or
+ *         malformed
+ */
+static rg_index_t *map_index(const char *path, const char *root) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return NULL;
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(index_header_t)) {
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (map == MAP_FAILED) return NULL;
+
+  size_t len = (size_t)st.st_size;
+  const index_header_t *h = map;
+  size_t root_len = strlen(root);
+  int ok = memcmp(h->magic, INDEX_MAGIC, 4) == 0 &&
+           h->format == INDEX_FORMAT &&
+           h->file_count <= len / sizeof(index_file_t) &&
+           h->trigram_count <= len / sizeof(index_trigram_t) &&
+           h->strings_len <= len && h->postings_len <= len &&
+           h->files_off == sizeof(index_header_t) &&
+           h->strings_off == h->files_off
+                             + h->file_count * sizeof(index_file_t) &&
+           h->postings_off == h->strings_off + h->strings_len &&
+           h->trigrams_off == h->postings_off + h->postings_len &&
+           h->trigrams_off + h->trigram_count * sizeof(index_trigram_t)
+             == len &&
+           h->trigrams_off % 8 == 0 &&
+           h->root_len == root_len && root_len <= h->strings_len &&
+           memcmp((const char *)map + h->strings_off, root, root_len) == 0;
+
+  rg_index_t *idx = ok ? calloc(1, sizeof(*idx)) : NULL;
+  if (!idx) {
+    munmap(map, len);
+    return NULL;
+  }
+  idx->map = map;
+  idx->map_len = len;
+  idx->header = h;
+  idx->files = (const index_file_t *)((const char *)map + h->files_off);
+  idx->trigrams = (const index_trigram_t *)((const char *)map
+                                            + h->trigrams_off);
+  idx->strings = (const char *)map + h->strings_off;
+  idx->postings = (const unsigned char *)map + h->postings_off;
+  return idx;
+}
+
+
+/**
+ * Gets the path of an indexed file relative to the root.
+ * @param idx Index
+ * @param id File number
+ * @param len Set to the length of the path
+ * @return The path (not NUL-terminated), or NULL if the entry is bad
+ */
+static const char *file_path(const rg_index_t *idx, size_t id, size_t *len) {
+  const index_file_t *f = &idx->files[id];
+  if (f->path_off > idx->header->strings_len
+      || f->path_len > idx->header->strings_len - f->path_off) {
+    return NULL;
+  }
+  *len = f->path_len;
+  return idx->strings + f->path_off;
+}
+
+
+/**
+ * Decodes a posting list.
+ * @param idx Index
+ * @param t Trigram entry
+ * @param ids Set to its t->count file numbers, ascending
+ * @return 0 on success, -1 if the list is malformed
+ */
+static int decode_postings(const rg_index_t *idx, const index_trigram_t *t,
+                           uint32_t *ids) {
+  size_t pos = (size_t)t->offset;
+  uint64_t id = 0;
+  for (uint32_t i = 0; i < t->count; i++) {
+    uint64_t delta;
+    if (get_varint(idx->postings, (size_t)idx->header->postings_len, &pos,
+                   &delta) != 0) {
+      return -1;
+    }
+    id += delta;
+    if (id >= idx->header->file_count) return -1;
+    ids[i] = (uint32_t)id;
+  }
+  return 0;
+}
+
+
+/**
+ * Finds a trigram's entry.
+ * @param idx Index
+ * @param trigram Trigram
+ * @return Entry, or NULL if no file contains the trigram
+ */
+static const index_trigram_t *find_trigram(const rg_index_t *idx,
+                                           uint32_t trigram) {
+  size_t lo = 0;
+  size_t hi = (size_t)idx->header->trigram_count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    uint32_t t = idx->trigrams[mid].trigram;
+    if (t == trigram) return &idx->trigrams[mid];
+    if (t < trigram) lo = mid + 1;
+    else hi = mid;
+  }
+  return NULL;
+}
+
+
+/**
+ * Collects the distinct trigrams of a file.
+ * @param path File to read
+ * @param buf Buffer of INDEX_CHUNK bytes
+ * @param seen Bitmap of TRIGRAM_SPACE bits, all clear; left clear
+ * @param file Gets the trigrams (none for a binary file)
+ * @return 0 on success, -1 on read error (errno set), 1 if out of memory
+ */
+static int read_trigrams(const char *path, unsigned char *buf,
+                         uint64_t *seen, build_file_t *file) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return -1;
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  uint32_t *list = NULL;
+  size_t count = 0;
+  size_t cap = 0;
+  uint32_t trigram = 0;
+  int have = 0;                 /* Bytes since the last newline, up to 3 */
+  int first = 1;
+  int rc = 0;
+  for (;;) {
+    ssize_t n = read(fd, buf, INDEX_CHUNK);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) {
+      rc = -1;
+      break;
+    }
+    if (n == 0) break;
+    if (first && memchr(buf, '\0', (size_t)n < INDEX_BINARY_PROBE
+                                   ? (size_t)n : INDEX_BINARY_PROBE)) {
+      break;                    /* Binary: rg never searches it */
+    }
+    first = 0;
+
+    for (ssize_t i = 0; i < n; i++) {
+      unsigned char c = fold(buf[i]);
+      if (c == '\n') {
+        have = 0;
+        continue;
+      }
+      trigram = ((trigram << 8) | c) & (TRIGRAM_SPACE - 1);
+      if (have < 3 && ++have < 3) continue;
+      uint64_t bit = 1ull << (trigram & 63);
+      if (seen[trigram >> 6] & bit) continue;
+      if (count == cap) {
+        size_t new_cap = cap == 0 ? 1024 : cap * 2;
+        uint32_t *grown = realloc(list, new_cap * sizeof(uint32_t));
+        if (!grown) {
+          rc = 1;
+          break;
+        }
+        list = grown;
+        cap = new_cap;
+      }
+      seen[trigram >> 6] |= bit;
+      list[count++] = trigram;
+    }
+    if (rc != 0) break;
+  }
+  close(fd);
+
+  for (size_t i = 0; i < count; i++) {
+    seen[list[i] >> 6] &= ~(1ull << (list[i] & 63));
+  }
+  if (rc != 0) {
+    free(list);
+    return rc;
+  }
+  file->trigrams = list;
+  file->trigram_count = count;
+  return 0;
+}
+
+
+/**
+ * Tells whether a file is as its old index entry recorded it.
+ * @param f Old entry
+ * @param st Current stat
+ * @return Non-zero if unchanged
+ */
+static int entry_matches(const index_file_t *f, const struct stat *st) {
+  return f->dev == (uint64_t)st->st_dev &&
+         f->ino == (uint64_t)st->st_ino &&
+         f->size == (uint64_t)st->st_size &&
+         f->mtime_sec == (int64_t)st->st_mtim.tv_sec &&
+         f->mtime_nsec == (int64_t)st->st_mtim.tv_nsec;
+}
+
+
+/**
+ * Marks the build as out of memory.
+ * @param pool Build pool
+ */
+static void pool_fail(build_pool_t *pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->failed = 1;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+
+/**
+ * Worker thread: stats the files of the range, or reads those of them
+ * that changed since the old index.
+ * @param arg build_pool_t
+ * @return NULL
+ */
+static void *build_worker(void *arg) {
+  build_pool_t *pool = arg;
+  jbox_ctx_adopt(pool->ctx);
+  unsigned char *buf = NULL;
+  uint64_t *seen = NULL;
+  if (!pool->stat_only) {
+    buf = malloc(INDEX_CHUNK);
+    seen = calloc(TRIGRAM_SPACE / 64, sizeof(uint64_t));
+    if (!buf || !seen) pool_fail(pool);
+  }
+
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    int stop = pool->failed || pool->next >= pool->end;
+    size_t i = pool->next++;
+    pthread_mutex_unlock(&pool->lock);
+    if (stop || jbox_is_interrupted()) break;
+
+    build_file_t *file = &pool->files[i];
+    if (pool->stat_only) {
+      /* A file gone since the walk is left out */
+      file->ok = stat(file->path, &file->st) == 0
+                 && S_ISREG(file->st.st_mode);
+      if (file->old_id >= 0 && (!file->ok || !entry_matches(
+              &pool->old->files[file->old_id], &file->st))) {
+        file->old_id = -1;
+      }
+      continue;
+    }
+    if (!file->ok || file->old_id >= 0) continue;
+
+    int rc = read_trigrams(file->path, buf, seen, file);
+    if (rc < 0) {
+      fprintf(stderr, "rg: %s: %s\n", file->path, strerror(errno));
+      file->unread = 1;
+    } else if (rc > 0) {
+      pool_fail(pool);
+    }
+  }
+
+  free(buf);
+  free(seen);
+  return NULL;
+}
+
+
+/**
+ * Stats or reads a range of files on a pool of threads.
+ * @param pool Files to process, with next and end set
+ * @return 0 on success, -1 if out of memory, -2 on interrupt
+ */
+static int run_pool(build_pool_t *pool) {
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int worker_count = cores > 0 ? (int)cores : 1;
+  if (worker_count > INDEX_MAX_WORKERS) worker_count = INDEX_MAX_WORKERS;
+  if ((size_t)worker_count > pool->end - pool->next) {
+    worker_count = (int)(pool->end - pool->next);
+  }
+
+  pthread_t threads[INDEX_MAX_WORKERS];
+  int started = 0;
+  for (int i = 0; i < worker_count; i++) {
+    if (pthread_create(&threads[i], NULL, build_worker, pool) != 0) break;
+    started++;
+  }
+  if (started == 0 && pool->next < pool->end) {
+    build_worker(pool);
+  }
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  if (jbox_is_interrupted()) return -2;
+  if (pool->failed) {
+    errno = ENOMEM;
+    return -1;
+  }
+  return 0;
+}
+
+
+/**
+ * Appends a pair.
+ * @param pairs Pair list
+ * @param trigram Trigram
+ * @param id File number
+ * @return 0 on success, -1 if out of memory
+ */
+static int pair_add(pair_list_t *pairs, uint32_t trigram, uint32_t id) {
+  if (pairs->count == pairs->cap) {
+    size_t new_cap = pairs->cap == 0 ? 65536 : pairs->cap * 2;
+    uint64_t *grown = realloc(pairs->items, new_cap * sizeof(uint64_t));
+    if (!grown) return -1;
+    pairs->items = grown;
+    pairs->cap = new_cap;
+  }
+  pairs->items[pairs->count++] = (uint64_t)trigram << 32 | id;
+  return 0;
+}
+
+
+/**
+ * Sorts pairs by trigram, then file, 16 bits at a time.
+ * @param pairs Pair list
+ * @return 0 on success, -1 if out of memory
+ */
+static int pair_sort(pair_list_t *pairs) {
+  uint64_t *tmp = malloc((pairs->count ? pairs->count : 1)
+                         * sizeof(uint64_t));
+  size_t *counts = malloc(65536 * sizeof(size_t));
+  if (!tmp || !counts) {
+    free(tmp);
+    free(counts);
+    return -1;
+  }
+
+  uint64_t *from = pairs->items;
+  uint64_t *to = tmp;
+  for (int shift = 0; shift < 64; shift += 16) {
+    memset(counts, 0, 65536 * sizeof(size_t));
+    for (size_t i = 0; i < pairs->count; i++) {
+      counts[(from[i] >> shift) & 0xffff]++;
+    }
+    size_t sum = 0;
+    for (size_t d = 0; d < 65536; d++) {
+      size_t c = counts[d];
+      counts[d] = sum;
+      sum += c;
+    }
+    for (size_t i = 0; i < pairs->count; i++) {
+      to[counts[(from[i] >> shift) & 0xffff]++] = from[i];
+    }
+    uint64_t *swap = from;
+    from = to;
+    to = swap;
+  }
+
+  /* An even number of passes leaves the result where it started */
+  free(tmp);
+  free(counts);
+  return 0;
+}
+
+
+/**
+ * Takes from the old posting lists the pairs of carried-over files with
+ * old numbers below a bound, renumbered.
+ * @param old Old index
+ * @param cursors Where each old list is up to
+ * @param bound Old file number to stop at
+ * @param old_to_new New number of each old file, or -1
+ * @param pairs Pair list to add to
+ * @return 0 on success, -1 if out of memory
+ */
+static int carry_pairs(const rg_index_t *old, old_cursor_t *cursors,
+                       uint32_t bound, const long *old_to_new,
+                       pair_list_t *pairs) {
+  size_t len = (size_t)old->header->postings_len;
+  for (size_t t = 0; t < old->header->trigram_count; t++) {
+    const index_trigram_t *entry = &old->trigrams[t];
+    old_cursor_t *c = &cursors[t];
+    while (c->done < entry->count && c->next < bound) {
+      long id = old_to_new[c->next];
+      if (id >= 0 && pair_add(pairs, entry->trigram, (uint32_t)id) != 0) {
+        return -1;
+      }
+      c->done++;
+      size_t pos = (size_t)c->pos;
+      uint64_t delta;
+      if (c->done < entry->count) {
+        if (get_varint(old->postings, len, &pos, &delta) != 0
+            || c->next + delta >= old->header->file_count) {
+          c->done = entry->count;     /* Malformed: drop the rest */
+          break;
+        }
+        c->next += (uint32_t)delta;
+        c->pos = pos;
+      }
+    }
+  }
+  return 0;
+}
+
+
+/**
+ * Sets up the cursors at the start of each old posting list.
+ * @param old Old index
+ * @param cursors One per old trigram
+ */
+static void carry_init(const rg_index_t *old, old_cursor_t *cursors) {
+  size_t len = (size_t)old->header->postings_len;
+  for (size_t t = 0; t < old->header->trigram_count; t++) {
+    const index_trigram_t *entry = &old->trigrams[t];
+    size_t pos = (size_t)entry->offset;
+    uint64_t first;
+    cursors[t].done = entry->count;
+    if (entry->count > 0 && get_varint(old->postings, len, &pos,
+                                       &first) == 0
+        && first < old->header->file_count) {
+      cursors[t].done = 0;
+      cursors[t].next = (uint32_t)first;
+      cursors[t].pos = pos;
+    }
+  }
+}
+
+
+/**
+ * Writes a batch's sorted pairs to the run file as posting lists.
+ * @param out Run file
+ * @param pairs Sorted pairs
+ * @param run Set to where the run was written
+ * @return 0 on success, -1 on error (errno set)
+ */
+static int write_run(FILE *out, const pair_list_t *pairs, run_t *run) {
+  index_trigram_t *trigrams = NULL;
+  size_t trigram_count = 0;
+  size_t trigram_cap = 0;
+  unsigned char *postings = NULL;
+  size_t postings_len = 0;
+  size_t postings_cap = 0;
+  int rc = 0;
+
+  uint32_t prev = 0;
+  for (size_t i = 0; i < pairs->count && rc == 0; i++) {
+    uint32_t trigram = (uint32_t)(pairs->items[i] >> 32);
+    uint32_t id = (uint32_t)pairs->items[i];
+    if (trigram_count == 0 || trigrams[trigram_count - 1].trigram != trigram) {
+      if (trigram_count == trigram_cap) {
+        size_t new_cap = trigram_cap == 0 ? 4096 : trigram_cap * 2;
+        index_trigram_t *grown = realloc(trigrams,
+                                         new_cap * sizeof(index_trigram_t));
+        if (!grown) {
+          rc = -1;
+          break;
+        }
+        trigrams = grown;
+        trigram_cap = new_cap;
+      }
+      trigrams[trigram_count++] = (index_trigram_t){
+        .trigram = trigram, .count = 0, .offset = postings_len
+      };
+      prev = 0;
+    }
+    trigrams[trigram_count - 1].count++;
+    rc = put_varint(&postings, &postings_len, &postings_cap, id - prev);
+    prev = id;
+  }
+  if (rc != 0) errno = ENOMEM;
+
+  /* Pad so the trigram table after the postings stays aligned */
+  static const unsigned char zeros[8];
+  size_t pad = (8 - postings_len % 8) % 8;
+  long start = ftell(out);
+  if (rc == 0 && start >= 0) {
+    run->postings_off = (uint64_t)start;
+    run->trigrams_off = (uint64_t)start + postings_len + pad;
+    run->trigram_count = trigram_count;
+    if ((postings_len > 0
+         && fwrite(postings, 1, postings_len, out) != postings_len)
+        || fwrite(zeros, 1, pad, out) != pad
+        || (trigram_count > 0
+            && fwrite(trigrams, sizeof(index_trigram_t), trigram_count,
+                      out) != trigram_count)) {
+      rc = -1;
+    }
+  } else if (rc == 0) {
+    rc = -1;
+  }
+
+  free(trigrams);
+  free(postings);
+  return rc;
+}
+
+
+/**
+ * Merges the runs into the index's postings and trigram table. The runs
+ * hold ascending ranges of files, so a trigram's list is its lists from
+ * the runs one after the other.
+ * @param map Mapped run file
+ * @param map_len Length of the run file
+ * @param runs Runs, in file order
+ * @param run_count Number of runs
+ * @param out Index file, positioned where the postings go
+ * @param postings_len Set to the bytes of postings written
+ * @param table Set to the trigram table. Caller must free.
+ * @param table_count Set to the number of trigrams
+ * @return 0 on success, -1 on error (errno set)
+ */
+static int merge_runs(const unsigned char *map, size_t map_len,
+                      const run_t *runs, size_t run_count, FILE *out,
+                      uint64_t *postings_len, index_trigram_t **table,
+                      size_t *table_count) {
+  size_t *at = calloc(run_count ? run_count : 1, sizeof(size_t));
+  unsigned char *buf = NULL;
+  size_t buf_len = 0;
+  size_t buf_cap = 0;
+  index_trigram_t *trigrams = NULL;
+  size_t count = 0;
+  size_t cap = 0;
+  uint64_t written = 0;
+  int rc = at ? 0 : -1;
+
+  while (rc == 0) {
+    /* The smallest trigram any run is at */
+    uint64_t next = UINT64_MAX;
+    for (size_t r = 0; r < run_count; r++) {
+      if (at[r] < runs[r].trigram_count) {
+        const index_trigram_t *t = (const index_trigram_t *)
+          (map + runs[r].trigrams_off) + at[r];
+        if (t->trigram < next) next = t->trigram;
+      }
+    }
+    if (next == UINT64_MAX) break;
+
+    if (count == cap) {
+      size_t new_cap = cap == 0 ? 4096 : cap * 2;
+      index_trigram_t *grown = realloc(trigrams,
+                                       new_cap * sizeof(index_trigram_t));
+      if (!grown) {
+        rc = -1;
+        break;
+      }
+      trigrams = grown;
+      cap = new_cap;
+    }
+    index_trigram_t *entry = &trigrams[count++];
+    *entry = (index_trigram_t){ .trigram = (uint32_t)next,
+                                .offset = written };
+
+    uint64_t prev = 0;
+    buf_len = 0;
+    for (size_t r = 0; r < run_count && rc == 0; r++) {
+      const index_trigram_t *t = (const index_trigram_t *)
+        (map + runs[r].trigrams_off) + at[r];
+      if (at[r] >= runs[r].trigram_count || t->trigram != next) continue;
+      at[r]++;
+
+      size_t pos = (size_t)(runs[r].postings_off + t->offset);
+      uint64_t id = 0;
+      for (uint32_t k = 0; k < t->count && rc == 0; k++) {
+        uint64_t delta;
+        if (get_varint(map, map_len, &pos, &delta) != 0) {
+          errno = EIO;
+          rc = -1;
+          break;
+        }
+        id += delta;
+        rc = put_varint(&buf, &buf_len, &buf_cap, id - prev);
+        prev = id;
+      }
+      entry->count += t->count;
+    }
+    if (rc == 0 && buf_len > 0 && fwrite(buf, 1, buf_len, out) != buf_len) {
+      rc = -1;
+    }
+    written += buf_len;
+  }
+
+  free(at);
+  free(buf);
+  *postings_len = written;
+  *table = trigrams;
+  *table_count = count;
+  return rc;
+}
+
+
+/**
+ * Builds or updates the index of a directory.
+ * @param dir Directory to index
+ * @param stats Set to what the index holds
+ * @return 0 on success, -1 on error (errno set), -2 on interrupt
+ */
+int rg_index_build(const char *dir, rg_index_stats_t *stats) {
+  memset(stats, 0, sizeof(*stats));
+  char root[PATH_MAX];
+  char path[PATH_MAX];
+  char tmp[PATH_MAX];
+  char run_path[PATH_MAX];
+  struct stat st;
+  if (!realpath(dir, root)) return -1;
+  if (stat(root, &st) != 0) return -1;
+  if (!S_ISDIR(st.st_mode)) {
+    errno = ENOTDIR;
+    return -1;
+  }
+  if (index_path(root, path, 1) != 0
+      || snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path,
+                  (long)getpid()) >= (int)sizeof(tmp)
+      || snprintf(run_path, sizeof(run_path), "%s.%ld.run", path,
+                  (long)getpid()) >= (int)sizeof(run_path)) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  rg_file_list_t list;
+  rg_file_list_init(&list);
+  int rc = rg_walk_collect(root, &list);
+  if (rc == -1) errno = ENOMEM;
+  if (rc != 0) {
+    rg_file_list_free(&list);
+    return rc;
+  }
+
+  /* Walked paths are "<root>/<relative path>" */
+  size_t rel_off = strcmp(root, "/") == 0 ? 1 : strlen(root) + 1;
+  rg_index_t *old = map_index(path, root);
+  size_t old_count = old ? (size_t)old->header->file_count : 0;
+  size_t old_trigrams = old ? (size_t)old->header->trigram_count : 0;
+  build_file_t *files = calloc(list.count ? list.count : 1,
+                               sizeof(build_file_t));
+  long *old_to_new = calloc(old_count ? old_count : 1, sizeof(long));
+  old_cursor_t *cursors = calloc(old_trigrams ? old_trigrams : 1,
+                                 sizeof(old_cursor_t));
+  pair_list_t pairs = {0};
+  run_t *runs = NULL;
+  size_t run_count = 0;
+  FILE *run_file = NULL;
+  FILE *out = NULL;
+  index_trigram_t *table = NULL;
+  size_t table_count = 0;
+  if (!files || !old_to_new || !cursors) {
+    errno = ENOMEM;
+    rc = -1;
+  }
+
+  /* Both lists are in walk order: match them up in one pass */
+  size_t j = 0;
+  for (size_t i = 0; rc == 0 && i < list.count; i++) {
+    files[i].path = list.paths[i];
+    files[i].old_id = -1;
+    const char *rel = list.paths[i] + rel_off;
+    while (j < old_count) {
+      size_t len;
+      const char *old_rel = file_path(old, j, &len);
+      char name[PATH_MAX];
+      if (!old_rel || len >= sizeof(name)) {
+        j++;
+        continue;
+      }
+      memcpy(name, old_rel, len);
+      name[len] = '\0';
+      int cmp = jbox_walk_compare_paths(name, rel);
+      if (cmp > 0) break;
+      j++;
+      if (cmp == 0) {
+        files[i].old_id = (long)j - 1;
+        break;
+      }
+    }
+  }
+
+  build_pool_t pool = {
+    .files = files,
+    .ctx = jbox_ctx_current(),
+    .old = old,
+  };
+  pthread_mutex_init(&pool.lock, NULL);
+  if (rc == 0) {
+    pool.end = list.count;
+    pool.stat_only = 1;
+    rc = run_pool(&pool);
+  }
+
+  /* Number the files that are in, in walk order */
+  uint32_t id = 0;
+  for (size_t i = 0; i < old_count; i++) old_to_new[i] = -1;
+  for (size_t i = 0; rc == 0 && i < list.count; i++) {
+    if (!files[i].ok) continue;
+    if (files[i].old_id >= 0) old_to_new[files[i].old_id] = id;
+    id++;
+  }
+  if (old) carry_init(old, cursors);
+
+  if (rc == 0) {
+    run_file = fopen(run_path, "w+e");
+    if (!run_file) rc = -1;
+  }
+
+  /* Batches of files small enough to sort their pairs in memory */
+  size_t lo = 0;
+  id = 0;
+  while (rc == 0 && lo < list.count) {
+    size_t hi = lo;
+    size_t budget = 0;
+    uint32_t old_bound = 0;
+    while (hi < list.count) {
+      build_file_t *f = &files[hi];
+      size_t need = 0;
+      if (f->ok && f->old_id >= 0) {
+        need = old->files[f->old_id].trigram_count;
+      } else if (f->ok) {
+        need = (size_t)f->st.st_size < TRIGRAM_SPACE
+               ? (size_t)f->st.st_size : TRIGRAM_SPACE;
+      }
+      if (hi > lo && budget + need > INDEX_BATCH_PAIRS) break;
+      budget += need;
+      if (f->ok && f->old_id >= 0) old_bound = (uint32_t)f->old_id + 1;
+      hi++;
+    }
+
+    pool.next = lo;
+    pool.end = hi;
+    pool.stat_only = 0;
+    rc = run_pool(&pool);
+
+    pairs.count = 0;
+    for (size_t i = lo; rc == 0 && i < hi; i++) {
+      build_file_t *f = &files[i];
+      if (!f->ok) continue;
+      if (f->old_id < 0) stats->read++;
+      for (size_t k = 0; k < f->trigram_count && rc == 0; k++) {
+        if (pair_add(&pairs, f->trigrams[k], id) != 0) rc = -1;
+      }
+      free(f->trigrams);
+      f->trigrams = NULL;
+      id++;
+    }
+    if (rc == 0 && old
+        && carry_pairs(old, cursors, old_bound, old_to_new, &pairs) != 0) {
+      rc = -1;
+    }
+    if (rc == 0 && pair_sort(&pairs) != 0) rc = -1;
+    if (rc == -1) errno = ENOMEM;
+
+    if (rc == 0 && pairs.count > 0) {
+      run_t *grown = realloc(runs, (run_count + 1) * sizeof(run_t));
+      if (!grown) {
+        errno = ENOMEM;
+        rc = -1;
+      } else {
+        runs = grown;
+        rc = write_run(run_file, &pairs, &runs[run_count]);
+        if (rc == 0) run_count++;
+      }
+    }
+    lo = hi;
+  }
+  free(pairs.items);
+  pthread_mutex_destroy(&pool.lock);
+
+  /* The file table and strings, then the merged runs, then the header
+   * once the sizes are known */
+  index_header_t h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, INDEX_MAGIC, 4);
+  h.format = INDEX_FORMAT;
+  h.root_len = strlen(root);
+  h.files_off = sizeof(h);
+  if (rc == 0) {
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    out = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!out) {
+      if (fd >= 0) close(fd);
+      rc = -1;
+    }
+  }
+  if (rc == 0) {
+    fwrite(&h, sizeof(h), 1, out);
+    uint64_t path_off = h.root_len;
+    for (size_t i = 0; i < list.count; i++) {
+      build_file_t *f = &files[i];
+      if (!f->ok) continue;
+      index_file_t entry = {
+        .dev = (uint64_t)f->st.st_dev,
+        .ino = (uint64_t)f->st.st_ino,
+        .size = (uint64_t)f->st.st_size,
+        .mtime_sec = (int64_t)f->st.st_mtim.tv_sec,
+        .mtime_nsec = f->unread ? INDEX_UNREAD
+                                : (int64_t)f->st.st_mtim.tv_nsec,
+        .path_off = path_off,
+        .path_len = (uint32_t)strlen(f->path + rel_off),
+        .trigram_count = f->old_id >= 0
+                         ? old->files[f->old_id].trigram_count
+                         : (uint32_t)f->trigram_count,
+      };
+      path_off += entry.path_len;
+      fwrite(&entry, sizeof(entry), 1, out);
+      h.file_count++;
+    }
+    h.strings_off = h.files_off + h.file_count * sizeof(index_file_t);
+    fwrite(root, 1, h.root_len, out);
+    for (size_t i = 0; i < list.count; i++) {
+      if (files[i].ok) fputs(files[i].path + rel_off, out);
+    }
+    h.strings_len = path_off;
+    h.postings_off = h.strings_off + h.strings_len;
+  }
+
+  if (rc == 0 && fflush(run_file) != 0) rc = -1;
+  long run_len = rc == 0 ? ftell(run_file) : -1;
+  if (rc == 0 && run_len < 0) rc = -1;
+  if (rc == 0 && run_len > 0) {
+    void *map = mmap(NULL, (size_t)run_len, PROT_READ, MAP_PRIVATE,
+                     fileno(run_file), 0);
+    if (map == MAP_FAILED) {
+      rc = -1;
+    } else {
+      rc = merge_runs(map, (size_t)run_len, runs, run_count, out,
+                      &h.postings_len, &table, &table_count);
+      munmap(map, (size_t)run_len);
+    }
+  }
+  if (rc == 0) {
+    static const unsigned char zeros[8];
+    size_t pad = (8 - (h.postings_off + h.postings_len) % 8) % 8;
+    fwrite(zeros, 1, pad, out);
+    h.postings_len += pad;
+    h.trigrams_off = h.postings_off + h.postings_len;
+    h.trigram_count = table_count;
+    if (table_count > 0) {
+      fwrite(table, sizeof(index_trigram_t), table_count, out);
+    }
+    if (fseek(out, 0, SEEK_SET) != 0) rc = -1;
+    fwrite(&h, sizeof(h), 1, out);
+    if (ferror(out)) rc = -1;
+  }
+  if (out) {
+    if (fclose(out) != 0) rc = -1;
+    if (rc == 0 && rename(tmp, path) != 0) rc = -1;
+    if (rc != 0) unlink(tmp);
+  }
+  if (run_file) {
+    fclose(run_file);
+    unlink(run_path);
+  }
+
+  stats->files = h.file_count;
+  stats->trigrams = table_count;
+  for (size_t i = 0; files && i < list.count; i++) {
+    free(files[i].trigrams);
+  }
+  free(files);
+  free(old_to_new);
+  free(cursors);
+  free(runs);
+  free(table);
+  rg_index_close(old);
+  rg_file_list_free(&list);
+  return rc;
+}
+
+
+/**
+ * Opens the index covering a directory.
+ * @param dir Directory to search
+ * @return Index, or NULL if there is none
+ */
+rg_index_t *rg_index_open(const char *dir) {
+  char real[PATH_MAX];
+  if (!realpath(dir, real)) return NULL;
+
+  char root[PATH_MAX];
+  memcpy(root, real, strlen(real) + 1);
+  for (;;) {
+    char path[PATH_MAX];
+    rg_index_t *idx = index_path(root, path, 0) == 0
+                      ? map_index(path, root) : NULL;
+    if (idx) {
+      size_t root_len = strcmp(root, "/") == 0 ? 0 : strlen(root);
+      const char *sub = real + root_len;
+      if (*sub == '/') sub++;
+      size_t sub_len = strlen(sub);
+      idx->sub = malloc(sub_len + 2);
+      if (!idx->sub) {
+        rg_index_close(idx);
+        return NULL;
+      }
+      memcpy(idx->sub, sub, sub_len);
+      if (sub_len > 0) idx->sub[sub_len++] = '/';
+      idx->sub[sub_len] = '\0';
+      return idx;
+    }
+
+    char *slash = strrchr(root, '/');
+    if (!slash || strcmp(root, "/") == 0) return NULL;
+    if (slash == root) slash[1] = '\0';
+    else *slash = '\0';
+  }
+}
+
+
+/**
+ * Intersects ascending file number lists in place.
+ * @param a First list, set to the intersection
+ * @param a_len Length of a
+ * @param b Second list
+ * @param b_len Length of b
+ * @return Length of the intersection
+ */
+static size_t intersect(uint32_t *a, size_t a_len, const uint32_t *b,
+                        size_t b_len) {
+  size_t i = 0, j = 0, n = 0;
+  while (i < a_len && j < b_len) {
+    if (a[i] < b[j]) i++;
+    else if (a[i] > b[j]) j++;
+    else {
+      a[n++] = a[i];
+      i++;
+      j++;
+    }
+  }
+  return n;
+}
+
+
+/**
+ * Orders trigram entries by the size of their posting lists.
+ * @param a First const index_trigram_t *
+ * @param b Second const index_trigram_t *
+ * @return Comparison result for qsort
+ */
+static int compare_count(const void *a, const void *b) {
+  uint32_t x = (*(const index_trigram_t *const *)a)->count;
+  uint32_t y = (*(const index_trigram_t *const *)b)->count;
+  return x < y ? -1 : x > y;
+}
+
+
+/**
+ * Narrows the files to those with every trigram of a literal.
+ * @param idx Index
+ * @param lit Literal, at least three bytes long
+ * @param ids Set to the candidate file numbers, ascending. Caller must
+ *        free.
+ * @param count Set to the number of candidates
+ * @return 0 on success, -1 on allocation failure
+ */
+static int literal_candidates(const rg_index_t *idx, const rg_literal_t *lit,
+                              uint32_t **ids, size_t *count) {
+  *ids = NULL;
+  *count = 0;
+
+  /* Smallest posting lists first, so the candidates shrink fastest */
+  size_t n = lit->len - 2;
+  const index_trigram_t **entries = malloc(n * sizeof(*entries));
+  if (!entries) return -1;
+  for (size_t i = 0; i < n; i++) {
+    const unsigned char *p = (const unsigned char *)lit->text + i;
+    uint32_t trigram = (uint32_t)fold(p[0]) << 16
+                       | (uint32_t)fold(p[1]) << 8 | fold(p[2]);
+    entries[i] = find_trigram(idx, trigram);
+    if (!entries[i]) {
+      free(entries);
+      return 0;                 /* No file has every trigram */
+    }
+  }
+  qsort(entries, n, sizeof(*entries), compare_count);
+
+  uint32_t *found = malloc((entries[0]->count ? entries[0]->count : 1)
+                           * sizeof(uint32_t));
+  uint32_t *other = malloc((entries[n - 1]->count ? entries[n - 1]->count
+                                                  : 1)
+                           * sizeof(uint32_t));
+  if (!found || !other) {
+    free(found);
+    free(other);
+    free(entries);
+    return -1;
+  }
+
+  size_t found_count = 0;
+  if (decode_postings(idx, entries[0], found) == 0) {
+    found_count = entries[0]->count;
+  }
+  for (size_t i = 1; i < n && found_count > 0; i++) {
+    if (entries[i] == entries[i - 1]) continue;
+    if (decode_postings(idx, entries[i], other) != 0) {
+      found_count = 0;
+      break;
+    }
+    found_count = intersect(found, found_count, other, entries[i]->count);
+  }
+  free(other);
+  free(entries);
+  *ids = found;
+  *count = found_count;
+  return 0;
+}
+
+
+/**
+ * Narrows the files to those with every trigram of any of several
+ * literals.
+ * @param idx Index
+ * @param lits Literals, each at least three bytes long
+ * @param lit_count Number of literals
+ * @param ids Set to the candidate file numbers, ascending. Caller must
+ *        free.
+ * @param count Set to the number of candidates
+ * @return 0 on success, -1 on allocation failure
+ */
+static int union_candidates(const rg_index_t *idx, const rg_literal_t *lits,
+                            size_t lit_count, uint32_t **ids,
+                            size_t *count) {
+  if (lit_count == 1) return literal_candidates(idx, &lits[0], ids, count);
+
+  size_t file_count = (size_t)idx->header->file_count;
+  uint64_t *bits = calloc(file_count / 64 + 1, sizeof(uint64_t));
+  if (!bits) return -1;
+  size_t found = 0;
+  for (size_t i = 0; i < lit_count; i++) {
+    uint32_t *one;
+    size_t one_count;
+    if (literal_candidates(idx, &lits[i], &one, &one_count) != 0) {
+      free(bits);
+      return -1;
+    }
+    for (size_t j = 0; j < one_count; j++) {
+      uint64_t bit = 1ull << (one[j] & 63);
+      if (!(bits[one[j] >> 6] & bit)) found++;
+      bits[one[j] >> 6] |= bit;
+    }
+    free(one);
+  }
+
+  *ids = malloc((found ? found : 1) * sizeof(uint32_t));
+  if (!*ids) {
+    free(bits);
+    return -1;
+  }
+  *count = 0;
+  for (size_t id = 0; id < file_count; id++) {
+    if (bits[id >> 6] & (1ull << (id & 63))) (*ids)[(*count)++] = (uint32_t)id;
+  }
+  free(bits);
+  return 0;
+}
+
+
+/**
+ * Lists the files under a directory that may contain any of several
+ * literals.
+ * @param idx Index covering dir
+ * @param dir Directory as given on the command line
+ * @param lits Literals, one of which every match contains
+ * @param lit_count Number of literals, 0 for none
+ * @param list List to add the paths to
+ * @return 0 on success, -1 on allocation failure
+ */
+int rg_index_candidates(const rg_index_t *idx, const char *dir,
+                        const rg_literal_t *lits, size_t lit_count,
+                        rg_file_list_t *list) {
+  uint32_t *ids = NULL;
+  size_t count = (size_t)idx->header->file_count;
+  int narrow = lit_count > 0;
+  for (size_t i = 0; i < lit_count; i++) {
+    if (lits[i].len < 3) narrow = 0;
+  }
+  if (narrow && union_candidates(idx, lits, lit_count, &ids, &count) != 0) {
+    return -1;
+  }
+
+  size_t sub_len = strlen(idx->sub);
+  size_t dir_len = strlen(dir);
+  int slash = dir_len > 0 && dir[dir_len - 1] != '/';
+  int rc = 0;
+  for (size_t i = 0; i < count && rc == 0; i++) {
+    size_t id = ids ? ids[i] : i;
+    size_t len;
+    const char *rel = file_path(idx, id, &len);
+    if (!rel || len <= sub_len || memcmp(rel, idx->sub, sub_len) != 0) {
+      continue;
+    }
+    rel += sub_len;
+    len -= sub_len;
+
+    char path[PATH_MAX];
+    if (dir_len + (size_t)slash + len >= sizeof(path)) continue;
+    memcpy(path, dir, dir_len);
+    if (slash) path[dir_len] = '/';
+    memcpy(path + dir_len + slash, rel, len);
+    path[dir_len + slash + len] = '\0';
+
+    struct stat st;
+    if (stat(path, &st) != 0) continue;   /* Deleted since */
+    if (rg_file_list_add(list, path) != 0) rc = -1;
+  }
+  free(ids);
+  return rc;
+}
+
+
+/**
+ * Releases an index.
+ * @param idx Index, or NULL
+ */
+void rg_index_close(rg_index_t *idx) {
+  if (!idx) return;
+  munmap(idx->map, idx->map_len);
+  free(idx->sub);
+  free(idx);
+}
@@ -0,0 +1,51 @@
+#ifndef RG_INDEX_H
+#define RG_INDEX_H
+
+#include <stddef.h>
+
+#include "rg_literal.h"
+#include "rg_walk.h"
+
+// Directory of trigram indexes, under the home directory
+#define RG_INDEX_SUBPATH "/.jshell/cache"
+
+// Trigram index of a directory tree, for rg --indexed
+//
+// The index lists the files rg would search under the directory, with
+// the device, inode, size and mtime each had when it was read, and for
+// every three-byte sequence in them (ASCII case folded, none spanning a
+// newline) the files that contain it, as delta-coded posting lists. It
+// is kept in ~/.jshell/cache as <hash of the directory>.rgix and mapped
+// into memory to search. Rebuilding rereads only the files whose stat
+// differs from the one recorded; the trigrams of the rest are carried
+// over from the old index.
+typedef struct rg_index rg_index_t;
+
+typedef struct {
+  size_t files;         // Files in the index
+  size_t read;          // Files read; the rest were carried over
+  size_t trigrams;      // Distinct trigrams
+} rg_index_stats_t;
+
+// Build or update the index of directory dir
+// Returns 0 on success, -1 on error (errno set), -2 on interrupt
+int rg_index_build(const char *dir, rg_index_stats_t *stats);
+
+// Open the index covering dir: the index of dir itself or of the nearest
+// directory above it that has one
+// Returns the index, or NULL if there is none or it is unusable
+rg_index_t *rg_index_open(const char *dir);
+
+// Add to list, in the order a walk of dir would find them, the files
+// under dir that may contain any of the lit_count literals in lits: all
+// of them when there are none or one is shorter than three bytes. Paths
+// start with dir as given. Files deleted since the index was built are
+// left out; files added since are not known.
+// Returns 0 on success, -1 on allocation failure
+int rg_index_candidates(const rg_index_t *idx, const char *dir,
+                        const rg_literal_t *lits, size_t lit_count,
+                        rg_file_list_t *list);
+
+void rg_index_close(rg_index_t *idx);
+
+#endif /* RG_INDEX_H */
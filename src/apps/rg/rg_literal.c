@@ -0,0 +1,230 @@
+/** @file rg_literal.c
+ *  @brief Literal-string matching for rg without the regex engine
+ *
+ *  Fixed strings, and the literal prefix of ordinary patterns, are found
+ *  with glibc's memchr/memmem. Those use the vectorized (SSE2/AVX2/NEON)
+ *  byte scans and the Two-Way algorithm selected for the running CPU, so
+ *  whole buffers can be scanned before splitting out the lines around
+ *  each hit.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "rg_literal.h"
+
+
+/** Characters with special meaning in a POSIX extended regex */
+static const char REGEX_META[] = ".[]()*+?{}|^$\\";
+
+
+/**
+ * ASCII lower-casing, matching REG_ICASE in the C locale.
+ * @param c Byte
+ * @return Lower-case byte
+ */
+static unsigned char fold(unsigned char c) {
+  return (c >= 'A' && c <= 'Z') ? (unsigned char)(c + ('a' - 'A')) : c;
+}
+
+
+/**
+ * Checks for a regex word character (alphanumeric or underscore).
+ * @param c Byte
+ * @return Non-zero if c is a word character in the C locale
+ */
+static int is_word_byte(unsigned char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+         || (c >= '0' && c <= '9') || c == '_';
+}
+
+
+/**
+ * Extracts the literal prefix every match of an extended regex starts
+ * with.
+ * @param pattern Regex source
+ * @param out Buffer for the unescaped prefix, at least strlen(pattern) + 1
+ * @param exact Set to 1 if the whole pattern is that literal
+ * @return Length of the prefix
+ */
+static size_t regex_prefix(const char *pattern, char *out, int *exact) {
+  size_t n = 0;
+  const char *p = pattern;
+  *exact = 0;
+
+  /* Any alternation means no single literal is required */
+  if (strchr(pattern, '|')) return 0;
+  if (*p == '^') p++;
+
+  while (*p) {
+    if (*p == '\\' && p[1] != '\0' && strchr(REGEX_META, p[1])) {
+      out[n++] = p[1];
+      p += 2;
+      continue;
+    }
+    if (*p == '*' || *p == '?' || *p == '{') {
+      if (n > 0) n--;   /* Previous character is optional */
+      out[n] = '\0';
+      return n;
+    }
+    if (strchr(REGEX_META, *p)) {
+      out[n] = '\0';
+      return n;         /* '+' keeps its character: it occurs at least once */
+    }
+    out[n++] = *p++;
+  }
+
+  out[n] = '\0';
+  *exact = pattern[0] != '^';
+  return n;
+}
+
+
+/**
+ * Works out the literal for a search pattern.
+ * @param lit Literal to fill in
+ * @param pattern Pattern as given on the command line
+ * @param fixed Whether the pattern is a fixed string (--fixed-strings)
+ * @param icase Whether matching ignores case
+ * @param word Whether matches must be whole words
+ * @return 0 if a literal was found, -1 if not
+ */
+int rg_literal_init(rg_literal_t *lit, const char *pattern, int fixed,
+                    int icase, int word) {
+  memset(lit, 0, sizeof(*lit));
+
+  size_t len = strlen(pattern);
+  char *text = malloc(len + 1);
+  if (!text) return -1;
+
+  int exact = 1;
+  if (fixed) {
+    memcpy(text, pattern, len + 1);
+  } else {
+    len = regex_prefix(pattern, text, &exact);
+  }
+  if (len == 0 || memchr(text, '\n', len)) {
+    free(text);
+    return -1;
+  }
+
+  /* \b only sits at a word/non-word edge, which a bare literal can't
+   * express when it starts or ends with punctuation */
+  if (word && exact) {
+    exact = is_word_byte((unsigned char)text[0])
+            && is_word_byte((unsigned char)text[len - 1]);
+  }
+
+  lit->text = text;
+  lit->len = len;
+  lit->icase = icase;
+  lit->word = word && exact;
+  lit->exact = exact;
+  return 0;
+}
+
+
+/**
+ * Frees a literal.
+ * @param lit Literal to free
+ */
+void rg_literal_free(rg_literal_t *lit) {
+  free(lit->text);
+  memset(lit, 0, sizeof(*lit));
+}
+
+
+/**
+ * Compares bytes ignoring ASCII case.
+ * @param a First buffer
+ * @param b Second buffer
+ * @param len Number of bytes
+ * @return Non-zero if equal
+ */
+static int equal_fold(const char *a, const char *b, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (fold((unsigned char)a[i]) != fold((unsigned char)b[i])) return 0;
+  }
+  return 1;
+}
+
+
+/**
+ * Finds the first occurrence of the literal, ignoring case.
+ *
+ * The first byte is located with memchr in both cases, then the rest is
+ * verified, so the scan still runs at vectorized memchr speed.
+ *
+ * @param lit Literal
+ * @param hay Buffer to search
+ * @param len Length of hay
+ * @return First occurrence, or NULL
+ */
+static const char *find_fold(const rg_literal_t *lit, const char *hay,
+                             size_t len) {
+  if (len < lit->len) return NULL;
+  const char *last = hay + (len - lit->len);
+  unsigned char lower = fold((unsigned char)lit->text[0]);
+  unsigned char upper = (lower >= 'a' && lower <= 'z')
+                        ? (unsigned char)(lower - ('a' - 'A')) : lower;
+
+  const char *next_lower = memchr(hay, lower, (size_t)(last - hay) + 1);
+  const char *next_upper = lower == upper ? NULL
+                           : memchr(hay, upper, (size_t)(last - hay) + 1);
+
+  while (next_lower || next_upper) {
+    const char *cand;
+    if (!next_upper || (next_lower && next_lower < next_upper)) {
+      cand = next_lower;
+    } else {
+      cand = next_upper;
+    }
+    if (equal_fold(cand + 1, lit->text + 1, lit->len - 1)) return cand;
+
+    const char *from = cand + 1;
+    size_t rest = from <= last ? (size_t)(last - from) + 1 : 0;
+    if (cand == next_lower) {
+      next_lower = rest ? memchr(from, lower, rest) : NULL;
+    } else {
+      next_upper = rest ? memchr(from, upper, rest) : NULL;
+    }
+  }
+  return NULL;
+}
+
+
+/**
+ * Finds the first occurrence of the literal in a buffer.
+ * @param lit Literal
+ * @param hay Buffer to search
+ * @param len Length of hay
+ * @return First occurrence (whole words only if lit->word), or NULL
+ */
+const char *rg_literal_find(const rg_literal_t *lit, const char *hay,
+                            size_t len) {
+  const char *end = hay + len;
+  const char *p = hay;
+
+  while (p < end) {
+    size_t rest = (size_t)(end - p);
+    const char *hit;
+    if (lit->icase) {
+      hit = find_fold(lit, p, rest);
+    } else if (lit->len == 1) {
+      hit = memchr(p, lit->text[0], rest);
+    } else {
+      hit = memmem(p, rest, lit->text, lit->len);
+    }
+    if (!hit || !lit->word) return hit;
+
+    const char *after = hit + lit->len;
+    if ((hit == hay || !is_word_byte((unsigned char)hit[-1]))
+        && (after == end || !is_word_byte((unsigned char)*after))) {
+      return hit;
+    }
+    p = hit + 1;
+  }
+  return NULL;
+}
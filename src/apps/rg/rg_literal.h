@@ -0,0 +1,29 @@
+#ifndef RG_LITERAL_H
+#define RG_LITERAL_H
+
+#include <stddef.h>
+
+// Literal string every match must contain, found without the regex engine
+typedef struct {
+  char *text;
+  size_t len;
+  int icase;            // ASCII case-insensitive, as REG_ICASE in the C locale
+  int word;             // Occurrences must be whole words (-w)
+  int exact;            // The literal alone decides a match; no regexec
+} rg_literal_t;
+
+// Work out the literal for a search pattern. With fixed set the pattern
+// is itself the literal; otherwise a literal prefix every match must
+// start with is taken from the extended regex, if there is one.
+// Returns 0 if a literal was found, -1 if not (or on allocation failure)
+int rg_literal_init(rg_literal_t *lit, const char *pattern, int fixed,
+                    int icase, int word);
+
+void rg_literal_free(rg_literal_t *lit);
+
+// First occurrence of the literal in hay (whole words only if lit->word),
+// or NULL
+const char *rg_literal_find(const rg_literal_t *lit, const char *hay,
+                            size_t len);
+
+#endif /* RG_LITERAL_H */
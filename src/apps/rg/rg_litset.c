@@ -0,0 +1,272 @@
+/** @file rg_litset.c
+ *  @brief Aho-Corasick search for the literals of several patterns
+ *
+ *  The literals form a trie whose failure links are folded into a full
+ *  transition table, so the scan never backtracks. Bytes that occur in
+ *  no literal share one column of the table, which keeps it small for
+ *  sets of identifiers, and while no literal is partly matched the scan
+ *  skips bytes that start none in a tight loop.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rg_litset.h"
+
+
+/** No state: end of an output chain */
+#define STATE_NONE UINT32_MAX
+
+/** Transitions hold the target's row offset, state * class_count, with
+ *  this bit set when a literal ends at the target */
+#define ROW_OUTPUT 0x80000000u
+#define ROW_MASK 0x7fffffffu
+
+
+struct rg_litset {
+  uint16_t classes[256];        /* Column of each byte; 0 for unused */
+  unsigned char starts[256];    /* Byte starts some literal */
+  size_t class_count;
+  uint32_t *next;               /* state * class_count + class: row
+                                 * offset of the target, and ROW_OUTPUT */
+  int32_t *out;                 /* Literal spelled by the state, or -1 */
+  uint32_t *out_link;           /* Longest proper suffix state with an
+                                 * output, or STATE_NONE */
+  size_t *lens;
+  unsigned char *word;          /* Occurrences must be whole words */
+  size_t max_len;
+};
+
+
+/**
+ * ASCII lower-casing, matching REG_ICASE in the C locale.
+ * @param c Byte
+ * @return Lower-case byte
+ */
+static unsigned char fold(unsigned char c) {
+  return (c >= 'A' && c <= 'Z') ? (unsigned char)(c + ('a' - 'A')) : c;
+}
+
+
+/**
+ * Checks for a regex word character (alphanumeric or underscore).
+ * @param c Byte
+ * @return Non-zero if c is a word character in the C locale
+ */
+static int is_word_byte(unsigned char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+         || (c >= '0' && c <= '9') || c == '_';
+}
+
+
+/**
+ * Gives each byte used by the literals a column; case variants share one
+ * under icase.
+ * @param set Set being built
+ * @param lits Literals
+ * @param count Number of literals
+ */
+static void assign_classes(rg_litset_t *set, const rg_literal_t *lits,
+                           size_t count) {
+  int icase = count > 0 && lits[0].icase;
+  set->class_count = 1;
+  for (size_t i = 0; i < count; i++) {
+    for (size_t j = 0; j < lits[i].len; j++) {
+      unsigned char c = (unsigned char)lits[i].text[j];
+      if (icase) c = fold(c);
+      if (set->classes[c] == 0) {
+        set->classes[c] = (uint16_t)set->class_count++;
+      }
+    }
+  }
+  if (icase) {
+    for (int c = 'A'; c <= 'Z'; c++) {
+      set->classes[c] = set->classes[fold((unsigned char)c)];
+    }
+  }
+  unsigned char first[257] = {0};
+  for (size_t i = 0; i < count; i++) {
+    first[set->classes[(unsigned char)lits[i].text[0]]] = 1;
+  }
+  for (int b = 0; b < 256; b++) {
+    set->starts[b] = first[set->classes[b]];
+  }
+}
+
+
+/**
+ * Builds the set of literals.
+ * @param lits Literals, sharing one icase setting
+ * @param count Number of literals
+ * @return Set, or NULL on allocation failure or if the literals are too
+ *         long in all for row offsets to fit in 31 bits
+ */
+rg_litset_t *rg_litset_new(const rg_literal_t *lits, size_t count) {
+  rg_litset_t *set = calloc(1, sizeof(*set));
+  if (!set) return NULL;
+
+  size_t total = 1;
+  for (size_t i = 0; i < count; i++) total += lits[i].len;
+  assign_classes(set, lits, count);
+  size_t k = set->class_count;
+  if (total > ROW_MASK / k) {
+    free(set);
+    return NULL;
+  }
+
+  set->next = calloc(total * k, sizeof(uint32_t));
+  set->out = malloc(total * sizeof(int32_t));
+  set->out_link = malloc(total * sizeof(uint32_t));
+  uint32_t *fail = malloc(total * sizeof(uint32_t));
+  uint32_t *queue = malloc(total * sizeof(uint32_t));
+  set->lens = malloc((count ? count : 1) * sizeof(size_t));
+  set->word = malloc(count ? count : 1);
+  if (!set->next || !set->out || !set->out_link || !fail || !queue
+      || !set->lens || !set->word) {
+    free(fail);
+    free(queue);
+    rg_litset_free(set);
+    return NULL;
+  }
+
+  /* The trie; 0 is the root, so no edge to 0 means no child yet */
+  size_t states = 1;
+  set->out[0] = -1;
+  for (size_t i = 0; i < count; i++) {
+    uint32_t s = 0;
+    for (size_t j = 0; j < lits[i].len; j++) {
+      unsigned char c = set->classes[(unsigned char)lits[i].text[j]];
+      uint32_t *edge = &set->next[s * k + c];
+      if (*edge == 0) {
+        set->out[states] = -1;
+        *edge = (uint32_t)states++;
+      }
+      s = *edge;
+    }
+    if (set->out[s] < 0) set->out[s] = (int32_t)i;
+    set->lens[i] = lits[i].len;
+    set->word[i] = (unsigned char)lits[i].word;
+    if (lits[i].len > set->max_len) set->max_len = lits[i].len;
+  }
+
+  /* Breadth first, so each state's failure state has its row complete */
+  size_t head = 0;
+  size_t tail = 0;
+  fail[0] = 0;
+  set->out_link[0] = STATE_NONE;
+  queue[tail++] = 0;
+  while (head < tail) {
+    uint32_t s = queue[head++];
+    for (size_t c = 0; c < k; c++) {
+      uint32_t *edge = &set->next[s * k + c];
+      uint32_t via_fail = s == 0 ? 0 : set->next[fail[s] * k + c];
+      if (*edge == 0) {
+        *edge = via_fail;
+        continue;
+      }
+      uint32_t child = *edge;
+      fail[child] = via_fail;
+      set->out_link[child] = set->out[via_fail] >= 0
+                             ? via_fail : set->out_link[via_fail];
+      queue[tail++] = child;
+    }
+  }
+
+  /* States to row offsets, flagged where a literal ends */
+  for (size_t i = 0; i < states * k; i++) {
+    uint32_t t = set->next[i];
+    int output = set->out[t] >= 0 || set->out_link[t] != STATE_NONE;
+    set->next[i] = (uint32_t)(t * k) | (output ? ROW_OUTPUT : 0);
+  }
+
+  free(fail);
+  free(queue);
+  return set;
+}
+
+
+/**
+ * Frees a set.
+ * @param set Set, or NULL
+ */
+void rg_litset_free(rg_litset_t *set) {
+  if (!set) return;
+  free(set->next);
+  free(set->out);
+  free(set->out_link);
+  free(set->lens);
+  free(set->word);
+  free(set);
+}
+
+
+/**
+ * Finds the leftmost-longest occurrence of any literal.
+ *
+ * Every occurrence ending at a byte is on the output chain of the state
+ * reached there. Once one is found the scan goes on only while a longer
+ * literal could still start at or before it.
+ *
+ * @param set Set
+ * @param hay Buffer to search
+ * @param len Length of hay
+ * @param from Offset to search from
+ * @param which Set to the index of the literal found
+ * @return Occurrence, or NULL
+ */
+const char *rg_litset_find(const rg_litset_t *set, const char *hay,
+                           size_t len, size_t from, size_t *which) {
+  const unsigned char *p = (const unsigned char *)hay;
+  size_t k = set->class_count;
+  size_t best = SIZE_MAX;
+  size_t best_len = 0;
+  size_t best_which = 0;
+  uint32_t row = 0;
+
+  for (size_t i = from; i < len; i++) {
+    if (row == 0) {
+      /* Nothing partly matched: later occurrences start after best */
+      if (best != SIZE_MAX) break;
+      while (i < len && !set->starts[p[i]]) i++;
+      if (i == len) break;
+    }
+    uint32_t t = set->next[row + set->classes[p[i]]];
+    row = t & ROW_MASK;
+    if (t & ROW_OUTPUT) {
+      uint32_t s = row / (uint32_t)k;
+      uint32_t o = set->out[s] >= 0 ? s : set->out_link[s];
+      for (; o != STATE_NONE; o = set->out_link[o]) {
+        size_t id = (size_t)set->out[o];
+        size_t n = set->lens[id];
+        size_t start = i + 1 - n;
+        if (set->word[id]
+            && ((start > 0 && is_word_byte(p[start - 1]))
+                || (i + 1 < len && is_word_byte(p[i + 1])))) {
+          continue;
+        }
+        if (start < best || (start == best && n > best_len)) {
+          best = start;
+          best_len = n;
+          best_which = id;
+        }
+      }
+    }
+    if (best != SIZE_MAX && i + 1 >= best + set->max_len) break;
+  }
+
+  if (best == SIZE_MAX) return NULL;
+  *which = best_which;
+  return hay + best;
+}
+
+
+/**
+ * Gets the length of a literal.
+ * @param set Set
+ * @param which Index of the literal
+ * @return Length
+ */
+size_t rg_litset_length(const rg_litset_t *set, size_t which) {
+  return set->lens[which];
+}
@@ -0,0 +1,33 @@
+#ifndef RG_LITSET_H
+#define RG_LITSET_H
+
+#include <stddef.h>
+
+#include "rg_literal.h"
+
+// Literals of several patterns, found together in one pass
+//
+// An Aho-Corasick automaton over the literals: scanning costs one table
+// lookup per byte however many literals there are, so hundreds of
+// identifiers are searched for in a single read of the input.
+typedef struct rg_litset rg_litset_t;
+
+// Build the set of count literals, which must share one icase setting.
+// Each literal's word flag applies to its own occurrences.
+// Returns the set, or NULL on allocation failure
+rg_litset_t *rg_litset_new(const rg_literal_t *lits, size_t count);
+
+void rg_litset_free(rg_litset_t *set);
+
+// Leftmost occurrence of any literal in hay starting at or after from,
+// the longest when several start there. The bytes before from still
+// decide word boundaries. *which is set to the literal's index (the
+// first given, for duplicates).
+// Returns the occurrence, or NULL
+const char *rg_litset_find(const rg_litset_t *set, const char *hay,
+                           size_t len, size_t from, size_t *which);
+
+// Length of literal which
+size_t rg_litset_length(const rg_litset_t *set, size_t which);
+
+#endif /* RG_LITSET_H */
@@ -0,0 +1,452 @@
+/** @file rg_pattern.c
+ *  @brief Searching for several patterns in one pass
+ *
+ *  Hundreds of patterns cost about what one does. Literal patterns are
+ *  found together by an Aho-Corasick automaton (rg_litset.c); the rest
+ *  are joined into one alternation, (p1)|(p2)|..., which the DFA runs in
+ *  a single scan. Which pattern matched is only worked out for lines that
+ *  match, and only when the caller asks, by trying each pattern at the
+ *  match's start.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rg_pattern.h"
+
+
+/**
+ * Escapes regex metacharacters for literal string matching.
+ * @param pattern Input pattern string
+ * @return Newly allocated escaped pattern, or NULL on error
+ */
+static char *escape_regex_pattern(const char *pattern) {
+  size_t len = strlen(pattern);
+  char *escaped = malloc(len * 2 + 1);
+  if (!escaped) return NULL;
+
+  size_t j = 0;
+  for (size_t i = 0; i < len; i++) {
+    char c = pattern[i];
+    if (strchr(".^$*+?()[{\\|", c)) {
+      escaped[j++] = '\\';
+    }
+    escaped[j++] = c;
+  }
+  escaped[j] = '\0';
+  return escaped;
+}
+
+
+/**
+ * Creates a word-boundary pattern for whole-word matching.
+ * @param pattern Input pattern string
+ * @param group Whether to group the pattern, so \b applies to each of
+ *        its alternatives
+ * @return Newly allocated word pattern, or NULL on error
+ */
+static char *create_word_pattern(const char *pattern, int group) {
+  size_t len = strlen(pattern);
+  char *word_pat = malloc(len + 20);
+  if (!word_pat) return NULL;
+  snprintf(word_pat, len + 20, group ? "\\b(%s)\\b" : "\\b%s\\b", pattern);
+  return word_pat;
+}
+
+
+/**
+ * Checks a regex for backreferences, which grouping would renumber.
+ * @param source Regex
+ * @return Non-zero if it has one
+ */
+static int has_backreference(const char *source) {
+  for (const char *p = source; *p; p++) {
+    if (*p != '\\' || p[1] == '\0') continue;
+    if (p[1] >= '1' && p[1] <= '9') return 1;
+    p++;
+  }
+  return 0;
+}
+
+
+/**
+ * Initializes an empty pattern set.
+ * @param p Pattern set
+ */
+void rg_patterns_init(rg_patterns_t *p) {
+  memset(p, 0, sizeof(*p));
+}
+
+
+/**
+ * Adds a pattern.
+ * @param p Pattern set
+ * @param pattern Pattern as given (copied)
+ * @return 0 on success, -1 on allocation failure
+ */
+int rg_patterns_add(rg_patterns_t *p, const char *pattern) {
+  if (p->count == p->cap) {
+    size_t new_cap = p->cap == 0 ? 8 : p->cap * 2;
+    char **grown = realloc(p->given, new_cap * sizeof(char *));
+    if (!grown) return -1;
+    p->given = grown;
+    p->cap = new_cap;
+  }
+  char *copy = strdup(pattern);
+  if (!copy) return -1;
+  p->given[p->count++] = copy;
+  return 0;
+}
+
+
+/**
+ * Adds each line of a file as a pattern.
+ * @param p Pattern set
+ * @param path File with one pattern per line
+ * @return 0 on success, -1 on error (errno set)
+ */
+int rg_patterns_add_file(rg_patterns_t *p, const char *path) {
+  FILE *f = fopen(path, "re");
+  if (!f) return -1;
+
+  char *line = NULL;
+  size_t cap = 0;
+  ssize_t n;
+  int rc = 0;
+  while ((n = getline(&line, &cap, f)) >= 0) {
+    if (n > 0 && line[n - 1] == '\n') line[n - 1] = '\0';
+    if (rg_patterns_add(p, line) != 0) {
+      errno = ENOMEM;
+      rc = -1;
+      break;
+    }
+  }
+  if (rc == 0 && ferror(f)) rc = -1;
+  int saved_errno = errno;
+  free(line);
+  fclose(f);
+  errno = saved_errno;
+  return rc;
+}
+
+
+/**
+ * Works out the literal of every pattern, keeping them only if each
+ * pattern has one.
+ * @param p Pattern set, with count > 0
+ * @param fixed Whether the patterns are fixed strings
+ * @param icase Whether matching ignores case
+ * @param word Whether matches must be whole words
+ * @return 0 on success, -1 on allocation failure
+ */
+static int prepare_literals(rg_patterns_t *p, int fixed, int icase,
+                            int word) {
+  rg_literal_t *lits = calloc(p->count, sizeof(rg_literal_t));
+  if (!lits) return -1;
+
+  int exact = 1;
+  size_t found = 0;
+  while (found < p->count && rg_literal_init(&lits[found], p->given[found],
+                                             fixed, icase, word) == 0) {
+    exact = exact && lits[found].exact;
+    found++;
+  }
+  if (found < p->count) {
+    for (size_t i = 0; i < found; i++) rg_literal_free(&lits[i]);
+    free(lits);
+    return 0;           /* No prefilter: some line may match without one */
+  }
+
+  p->literals = lits;
+  p->exact = exact;
+  if (p->count > 1) {
+    p->set = rg_litset_new(lits, p->count);
+    if (!p->set) return -1;
+  }
+  return 0;
+}
+
+
+/**
+ * Works out the sources, combined regex and literals.
+ * @param p Pattern set
+ * @param fixed Whether the patterns are fixed strings (--fixed-strings)
+ * @param icase Whether matching ignores case
+ * @param word Whether matches must be whole words
+ * @return 0 on success, -1 on allocation failure
+ */
+int rg_patterns_prepare(rg_patterns_t *p, int fixed, int icase, int word) {
+  p->cflags = REG_EXTENDED | REG_NEWLINE;
+  if (icase) {
+    p->cflags |= REG_ICASE;
+  }
+  if (p->count == 0) return 0;
+
+  p->sources = calloc(p->count, sizeof(char *));
+  if (!p->sources) return -1;
+  int backrefs = 0;
+  size_t combined_len = 0;
+  for (size_t i = 0; i < p->count; i++) {
+    char *source = fixed ? escape_regex_pattern(p->given[i])
+                         : strdup(p->given[i]);
+    if (!source) return -1;
+    int backref = !fixed && has_backreference(source);
+    backrefs = backrefs || backref;
+    if (word) {
+      char *word_pat = create_word_pattern(source, p->count > 1 && !backref);
+      free(source);
+      if (!word_pat) return -1;
+      source = word_pat;
+    }
+    p->sources[i] = source;
+    combined_len += strlen(source) + 3;
+  }
+
+  if (p->count == 1) {
+    p->combined = strdup(p->sources[0]);
+    if (!p->combined) return -1;
+  } else if (!backrefs) {
+    p->combined = malloc(combined_len + 1);
+    if (!p->combined) return -1;
+    char *out = p->combined;
+    for (size_t i = 0; i < p->count; i++) {
+      out += sprintf(out, "%s(%s)", i > 0 ? "|" : "", p->sources[i]);
+    }
+  }
+
+  return prepare_literals(p, fixed, icase, word);
+}
+
+
+/**
+ * Frees a pattern set.
+ * @param p Pattern set
+ */
+void rg_patterns_free(rg_patterns_t *p) {
+  for (size_t i = 0; i < p->count; i++) {
+    free(p->given[i]);
+    if (p->sources) free(p->sources[i]);
+    if (p->literals) rg_literal_free(&p->literals[i]);
+  }
+  free(p->given);
+  free(p->sources);
+  free(p->literals);
+  free(p->combined);
+  rg_litset_free(p->set);
+  memset(p, 0, sizeof(*p));
+}
+
+
+/**
+ * Finds the first occurrence of any pattern's literal.
+ * @param p Pattern set with literals
+ * @param hay Buffer to search
+ * @param len Length of hay
+ * @return First occurrence, or NULL
+ */
+const char *rg_patterns_find(const rg_patterns_t *p, const char *hay,
+                             size_t len) {
+  if (!p->set) return rg_literal_find(&p->literals[0], hay, len);
+  size_t which;
+  return rg_litset_find(p->set, hay, len, 0, &which);
+}
+
+
+/**
+ * Compiles each pattern on its own.
+ * @param m Matcher
+ * @param err Buffer for an error message
+ * @param err_size Size of err
+ * @return 0 on success, or the regcomp() error code
+ */
+static int compile_each(rg_matcher_t *m, char *err, size_t err_size) {
+  const rg_patterns_t *p = m->patterns;
+  jbox_regex_t *each = calloc(p->count, sizeof(jbox_regex_t));
+  if (!each) {
+    snprintf(err, err_size, "%s", strerror(ENOMEM));
+    return REG_ESPACE;
+  }
+  for (size_t i = 0; i < p->count; i++) {
+    int rc = jbox_regex_compile(&each[i], p->sources[i], p->cflags);
+    if (rc != 0) {
+      jbox_regex_error(rc, &each[i], err, err_size);
+      while (i > 0) jbox_regex_free(&each[--i]);
+      free(each);
+      return rc;
+    }
+  }
+  m->each = each;
+  return 0;
+}
+
+
+/**
+ * Compiles the patterns for the calling thread.
+ * @param m Matcher to initialize
+ * @param p Prepared pattern set
+ * @param err Buffer for an error message
+ * @param err_size Size of err
+ * @return 0 on success, or the regcomp() error code
+ */
+int rg_matcher_init(rg_matcher_t *m, const rg_patterns_t *p, char *err,
+                    size_t err_size) {
+  memset(m, 0, sizeof(*m));
+  m->patterns = p;
+  if (p->count == 0 || (p->exact && p->set)) return 0;
+
+  if (!p->combined) return compile_each(m, err, err_size);
+  int rc = jbox_regex_compile(&m->regex, p->combined, p->cflags);
+  if (rc != 0) {
+    jbox_regex_error(rc, &m->regex, err, err_size);
+    return rc;
+  }
+  m->compiled = 1;
+  return 0;
+}
+
+
+/**
+ * Frees a matcher.
+ * @param m Matcher
+ */
+void rg_matcher_free(rg_matcher_t *m) {
+  if (m->compiled) jbox_regex_free(&m->regex);
+  if (m->each) {
+    for (size_t i = 0; i < m->patterns->count; i++) {
+      jbox_regex_free(&m->each[i]);
+    }
+    free(m->each);
+  }
+  memset(m, 0, sizeof(*m));
+}
+
+
+/**
+ * Works out which pattern a match of the combined regex is of: the first
+ * that matches the same text, or else the first that matches there.
+ * @param m Matcher
+ * @param line Line
+ * @param len Length of line
+ * @param found Match of the combined regex
+ * @return Index of the pattern
+ */
+static size_t identify(rg_matcher_t *m, const char *line, size_t len,
+                       regmatch_t found) {
+  char err[128];
+  if (!m->each && compile_each(m, err, sizeof(err)) != 0) return 0;
+
+  size_t first = SIZE_MAX;
+  for (size_t i = 0; i < m->patterns->count; i++) {
+    regmatch_t mm;
+    if (jbox_regex_exec_at(&m->each[i], line, len, (size_t)found.rm_so,
+                           &mm) != 0 || mm.rm_so != found.rm_so) {
+      continue;
+    }
+    if (mm.rm_eo == found.rm_eo) return i;
+    if (first == SIZE_MAX) first = i;
+  }
+  return first == SIZE_MAX ? 0 : first;
+}
+
+
+/**
+ * Tests a line against the pattern set.
+ *
+ * A line without any pattern's literal is rejected without running a
+ * regex, and when the literals are the whole patterns they decide alone.
+ *
+ * @param m Matcher
+ * @param line NUL-terminated line
+ * @param len Length of line
+ * @param match Set to the offsets of the first match, or NULL
+ * @param which Set to the index of the pattern matched, or NULL
+ * @return Non-zero if the line matches
+ */
+int rg_matcher_match(rg_matcher_t *m, const char *line, size_t len,
+                     regmatch_t *match, size_t *which) {
+  const rg_patterns_t *p = m->patterns;
+  if (p->count == 0) return 0;
+
+  if (p->literals) {
+    size_t id = 0;
+    const char *hit = p->set ? rg_litset_find(p->set, line, len, 0, &id)
+                             : rg_literal_find(&p->literals[0], line, len);
+    if (!hit) return 0;
+    if (p->exact) {
+      if (match) {
+        match->rm_so = (regoff_t)(hit - line);
+        match->rm_eo = (regoff_t)(hit - line + p->literals[id].len);
+      }
+      if (which) *which = id;
+      return 1;
+    }
+  }
+
+  return rg_matcher_match_at(m, line, len, 0, match, which);
+}
+
+
+/**
+ * Finds the first match starting at or after an offset.
+ * @param m Matcher
+ * @param line NUL-terminated line
+ * @param len Length of line
+ * @param from Offset to search from
+ * @param match Set to the offsets of the match, or NULL
+ * @param which Set to the index of the pattern matched, or NULL
+ * @return Non-zero if there is a match
+ */
+int rg_matcher_match_at(rg_matcher_t *m, const char *line, size_t len,
+                        size_t from, regmatch_t *match, size_t *which) {
+  const rg_patterns_t *p = m->patterns;
+  if (p->count == 0) return 0;
+
+  if (p->exact && p->set) {
+    size_t id;
+    const char *hit = rg_litset_find(p->set, line, len, from, &id);
+    if (!hit) return 0;
+    if (match) {
+      match->rm_so = (regoff_t)(hit - line);
+      match->rm_eo = (regoff_t)(hit - line + rg_litset_length(p->set, id));
+    }
+    if (which) *which = id;
+    return 1;
+  }
+
+  regmatch_t local;
+  int identify_needed = which && p->count > 1;
+  regmatch_t *want = match ? match : identify_needed ? &local : NULL;
+  if (m->compiled) {
+    int rc = from == 0 ? jbox_regex_exec(&m->regex, line, len, want)
+                       : jbox_regex_exec_at(&m->regex, line, len, from,
+                                            want);
+    if (rc != 0) return 0;
+    if (which) *which = identify_needed ? identify(m, line, len, *want) : 0;
+    return 1;
+  }
+
+  /* One at a time: the leftmost match, the longest of those */
+  int found = 0;
+  regmatch_t best = { 0, 0 };
+  size_t best_which = 0;
+  for (size_t i = 0; i < p->count; i++) {
+    regmatch_t mm;
+    if (jbox_regex_exec_at(&m->each[i], line, len, from, &mm) != 0) continue;
+    if (!want && !which) return 1;
+    if (!found || mm.rm_so < best.rm_so
+        || (mm.rm_so == best.rm_so && mm.rm_eo > best.rm_eo)) {
+      best = mm;
+      best_which = i;
+      found = 1;
+    }
+  }
+  if (!found) return 0;
+  if (match) *match = best;
+  if (which) *which = best_which;
+  return 1;
+}
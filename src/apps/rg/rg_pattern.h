@@ -0,0 +1,80 @@
+#ifndef RG_PATTERN_H
+#define RG_PATTERN_H
+
+#include <stddef.h>
+
+#include "utils/jbox_regex.h"
+#include "rg_literal.h"
+#include "rg_litset.h"
+
+// Patterns searched for together: PATTERN, or every -e and -f given
+//
+// A line matches if any pattern does. When every pattern comes down to a
+// literal (fixed strings, plain words) the literals are found in one pass
+// by an Aho-Corasick set and no regex runs; otherwise the patterns are
+// compiled into one alternation, matched by a single DFA, with their
+// literals, when each has one, as a prefilter.
+typedef struct {
+  char **given;         // As given, reported in JSON
+  size_t count;
+  size_t cap;
+  char **sources;       // Regex of each: escaped, wrapped in \b under -w
+  char *combined;       // Every source as one regex, or NULL to match them
+                        // one at a time (backreferences)
+  int cflags;
+  rg_literal_t *literals;  // Literal of each pattern, or NULL if one has
+                           // none
+  int exact;            // The literals alone decide matches
+  rg_litset_t *set;     // The literals as one automaton, for count > 1
+} rg_patterns_t;
+
+// Patterns compiled for one thread: DFA caches are not shared
+typedef struct {
+  const rg_patterns_t *patterns;
+  jbox_regex_t regex;   // combined, unless exact with several patterns
+  int compiled;
+  jbox_regex_t *each;   // Each source, compiled when first needed
+} rg_matcher_t;
+
+void rg_patterns_init(rg_patterns_t *p);
+
+// Add a pattern
+// Returns 0 on success, -1 on allocation failure
+int rg_patterns_add(rg_patterns_t *p, const char *pattern);
+
+// Add each line of a file as a pattern (-f)
+// Returns 0 on success, -1 on error (errno set)
+int rg_patterns_add_file(rg_patterns_t *p, const char *path);
+
+// Work out the sources, combined regex and literals once every pattern
+// is added
+// Returns 0 on success, -1 on allocation failure
+int rg_patterns_prepare(rg_patterns_t *p, int fixed, int icase, int word);
+
+void rg_patterns_free(rg_patterns_t *p);
+
+// First occurrence in hay of any pattern's literal; p->literals must be
+// set. Lines without one cannot match.
+const char *rg_patterns_find(const rg_patterns_t *p, const char *hay,
+                             size_t len);
+
+// Compile the patterns for this thread
+// Returns 0 on success, or the regcomp() error code, described into err
+int rg_matcher_init(rg_matcher_t *m, const rg_patterns_t *p, char *err,
+                    size_t err_size);
+
+void rg_matcher_free(rg_matcher_t *m);
+
+// Test a line. match, if non-NULL, is set to the leftmost-longest match
+// (passing NULL lets the search stop at the first hit), and which, if
+// non-NULL, to the index of the pattern that matched there.
+// Returns non-zero if the line matches
+int rg_matcher_match(rg_matcher_t *m, const char *line, size_t len,
+                     regmatch_t *match, size_t *which);
+
+// As rg_matcher_match, for the first match starting at or after from;
+// the bytes before it still decide ^ and word boundaries
+int rg_matcher_match_at(rg_matcher_t *m, const char *line, size_t len,
+                        size_t from, regmatch_t *match, size_t *which);
+
+#endif /* RG_PATTERN_H */
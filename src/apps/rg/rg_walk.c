@@ -0,0 +1,147 @@
+/** @file rg_walk.c
+ *  @brief Recursive directory traversal for rg with .gitignore support
+ *
+ *  The tree is read in parallel by jbox_walk(), which applies the
+ *  .gitignore rules and skips .git. Files arrive in whatever order the
+ *  walker threads find them, so the list is sorted afterwards into the
+ *  order of a depth-first walk by name, which makes rg's output the same
+ *  from run to run.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "rg_walk.h"
+#include "utils/jbox_walk.h"
+
+
+/** State shared by the walker threads while collecting */
+typedef struct {
+  rg_file_list_t *list;
+  int failed;                   /* A path could not be added */
+  pthread_mutex_t lock;
+} collect_state_t;
+
+
+/**
+ * Initializes an empty file list.
+ * @param list List to initialize
+ */
+void rg_file_list_init(rg_file_list_t *list) {
+  list->paths = NULL;
+  list->count = 0;
+  list->capacity = 0;
+}
+
+
+/**
+ * Frees a file list and its paths.
+ * @param list List to free
+ */
+void rg_file_list_free(rg_file_list_t *list) {
+  for (size_t i = 0; i < list->count; i++) {
+    free(list->paths[i]);
+  }
+  free(list->paths);
+  rg_file_list_init(list);
+}
+
+
+/**
+ * Appends a copy of a path to a file list.
+ * @param list File list
+ * @param path Path to add
+ * @return 0 on success, -1 on allocation failure
+ */
+int rg_file_list_add(rg_file_list_t *list, const char *path) {
+  if (list->count >= list->capacity) {
+    size_t new_cap = list->capacity == 0 ? 256 : list->capacity * 2;
+    char **grown = realloc(list->paths, new_cap * sizeof(char *));
+    if (!grown) return -1;
+    list->paths = grown;
+    list->capacity = new_cap;
+  }
+  list->paths[list->count] = strdup(path);
+  if (!list->paths[list->count]) return -1;
+  list->count++;
+  return 0;
+}
+
+
+/**
+ * Adds each regular file the walker finds to the list.
+ * @param entry Entry found
+ * @param arg The collect_state_t
+ * @return JBOX_WALK_CONTINUE, or JBOX_WALK_STOP if out of memory
+ */
+static int collect_visit(jbox_walk_entry_t *entry, void *arg) {
+  collect_state_t *state = arg;
+  if (entry->type != DT_REG || entry->depth == 0) {
+    return JBOX_WALK_CONTINUE;
+  }
+
+  pthread_mutex_lock(&state->lock);
+  int rc = rg_file_list_add(state->list, entry->path);
+  if (rc != 0) state->failed = 1;
+  pthread_mutex_unlock(&state->lock);
+  return rc == 0 ? JBOX_WALK_CONTINUE : JBOX_WALK_STOP;
+}
+
+
+/**
+ * Reports a directory that cannot be read.
+ * @param path Path of the directory
+ * @param err errno of the failure
+ * @param arg Unused
+ */
+static void collect_error(const char *path, int err, void *arg) {
+  (void)arg;
+  fprintf(stderr, "rg: %s: %s\n", path, strerror(err));
+}
+
+
+/**
+ * Orders paths as a depth-first walk by name would.
+ * @param a First char *
+ * @param b Second char *
+ * @return Comparison result for qsort
+ */
+static int compare_paths(const void *a, const void *b) {
+  return jbox_walk_compare_paths(*(char *const *)a, *(char *const *)b);
+}
+
+
+/**
+ * Collects the regular files under a directory.
+ * @param root Directory to walk
+ * @param list File list to append to
+ * @return 0 on success, -1 on allocation failure, -2 on interrupt
+ */
+int rg_walk_collect(const char *root, rg_file_list_t *list) {
+  collect_state_t state = { .list = list };
+  pthread_mutex_init(&state.lock, NULL);
+
+  size_t first = list->count;
+  jbox_walk_options_t opts = {
+    .flags = JBOX_WALK_GITIGNORE | JBOX_WALK_SKIP_GIT,
+    .max_depth = -1,
+    .visit = collect_visit,
+    .error = collect_error,
+    .arg = &state,
+  };
+  int result = jbox_walk(root, &opts);
+  pthread_mutex_destroy(&state.lock);
+  if (result == 0 && state.failed) result = -1;
+
+  if (list->count - first > 1) {
+    qsort(list->paths + first, list->count - first, sizeof(char *),
+          compare_paths);
+  }
+  return result;
+}
@@ -0,0 +1,26 @@
+#ifndef RG_WALK_H
+#define RG_WALK_H
+
+#include <stddef.h>
+
+// Files found under a directory, in a deterministic (sorted) order
+typedef struct {
+  char **paths;
+  size_t count;
+  size_t capacity;
+} rg_file_list_t;
+
+void rg_file_list_init(rg_file_list_t *list);
+
+void rg_file_list_free(rg_file_list_t *list);
+
+// Append a copy of path; returns 0 on success, -1 on allocation failure
+int rg_file_list_add(rg_file_list_t *list, const char *path);
+
+// Recursively collect the regular files under root, skipping .git and
+// anything matched by a .gitignore inside the tree. Symlinks are not
+// followed. Directories that cannot be read are reported on stderr.
+// Returns 0 on success, -1 on allocation failure, -2 on interrupt
+int rg_walk_collect(const char *root, rg_file_list_t *list);
+
+#endif /* RG_WALK_H */
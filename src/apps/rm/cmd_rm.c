@@ -2,16 +2,26 @@
  *  @brief Implementation of the rm command for removing files and directories.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
-#include <sys/stat.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_ctx.h"
+#include "utils/jbox_remove.h"
+#include "utils/jbox_signals.h"
 
 
 /**
@@ -22,12 +32,34 @@ typedef struct {
   struct arg_lit *recursive;
   struct arg_lit *force;
   struct arg_lit *json;
+  struct arg_lit *async;
   struct arg_file *files;
   struct arg_end *end;
-  void *argtable[6];
+  void *argtable[7];
 } rm_args_t;
 
 
+/** Name of the directory targets are renamed into under --async */
+#define RM_TRASH_NAME ".jbox-trash"
+
+/** Trash directories used by one run, reclaimed once it is done */
+#define RM_MAX_TRASH 16
+
+/** ioprio_set() arguments for the idle I/O class (linux/ioprio.h) */
+#define RM_IOPRIO_WHO_PROCESS 1
+#define RM_IOPRIO_CLASS_IDLE 3
+#define RM_IOPRIO_CLASS_SHIFT 13
+
+
+/**
+ * @brief Trash directories that received targets during this run.
+ */
+typedef struct {
+  char *dirs[RM_MAX_TRASH];
+  int count;
+} rm_trash_t;
+
+
 /**
  * @brief Builds the argtable3 structure for rm command arguments.
  * @param args Pointer to rm_args_t structure to populate.
@@ -39,6 +71,8 @@ static void build_rm_argtable(rm_args_t *args) {
   args->force     = arg_lit0("f", "force", "ignore nonexistent files, never "
                              "prompt");
   args->json      = arg_lit0(NULL, "json", "output in JSON format");
+  args->async     = arg_lit0(NULL, "async", "move targets to trash and "
+                             "delete them in the background");
   args->files     = arg_filen(NULL, NULL, "FILE", 1, 100, "files or "
                               "directories to remove");
   args->end       = arg_end(20);
@@ -47,8 +81,9 @@ static void build_rm_argtable(rm_args_t *args) {
   args->argtable[1] = args->recursive;
   args->argtable[2] = args->force;
   args->argtable[3] = args->json;
-  args->argtable[4] = args->files;
-  args->argtable[5] = args->end;
+  args->argtable[4] = args->async;
+  args->argtable[5] = args->files;
+  args->argtable[6] = args->end;
 }
 
 
@@ -78,6 +113,21 @@ static void rm_print_usage(FILE *out) {
 }
 
 
+/**
+ * @brief Passes the rm argtable to visit, for tool
+ *        schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void rm_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  rm_args_t args;
+  build_rm_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_rm_argtable(&args);
+}
+
+
 /**
  * @brief Escapes special characters in a string for JSON output.
  * @param str Input string to escape.
@@ -112,15 +162,17 @@ static void escape_json_string(const char *str, char *out, size_t out_size) {
 }
 
 
-static int remove_directory_recursive(const char *path);
-
-
 /**
  * @brief Removes a single file or directory entry.
+ *
+ * Directories are handed to jbox_remove_tree(), which empties them
+ * through directory descriptors, with sibling subtrees removed in
+ * parallel.
+ *
  * @param path Path to remove.
  * @param recursive If non-zero, recursively remove directories.
  * @param force If non-zero, ignore nonexistent files.
- * @return 0 on success, -1 on failure.
+ * @return 0 on success, -1 on failure, -2 if interrupted.
  */
 static int remove_entry(const char *path, int recursive, int force) {
   struct stat st;
@@ -136,7 +188,7 @@ static int remove_entry(const char *path, int recursive, int force) {
       errno = EISDIR;
       return -1;
     }
-    return remove_directory_recursive(path);
+    return jbox_remove_tree(path);
   } else {
     return unlink(path);
   }
@@ -144,47 +196,275 @@ static int remove_entry(const char *path, int recursive, int force) {
 
 
 /**
- * @brief Recursively removes a directory and all its contents.
- * @param path Directory path to remove.
+ * @brief Finds the root of the filesystem holding a directory.
+ *
+ * Walks up through ".." until the device changes or "/" is reached.
+ *
+ * @param dir Existing directory.
+ * @param out Buffer receiving the mount root.
+ * @param out_size Size of out.
  * @return 0 on success, -1 on failure.
  */
-static int remove_directory_recursive(const char *path) {
-  DIR *dir = opendir(path);
-  if (!dir) {
+static int find_mount_root(const char *dir, char *out, size_t out_size) {
+  char *path = realpath(dir, NULL);
+  if (!path) {
+    return -1;
+  }
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    free(path);
     return -1;
   }
 
-  int result = 0;
-  struct dirent *entry;
+  while (strcmp(path, "/") != 0) {
+    char *slash = strrchr(path, '/');
+    struct stat up;
+    if (slash == path) {
+      if (stat("/", &up) != 0 || up.st_dev != st.st_dev) break;
+      path[1] = '\0';
+      break;
+    }
+    *slash = '\0';
+    if (stat(path, &up) != 0 || up.st_dev != st.st_dev) {
+      *slash = '/';
+      break;
+    }
+  }
+
+  int ok = snprintf(out, out_size, "%s", path) < (int)out_size;
+  free(path);
+  return ok ? 0 : -1;
+}
+
 
-  while ((entry = readdir(dir)) != NULL) {
-    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-      continue;
+/**
+ * @brief Moves a target into a trash directory under a fresh name.
+ *
+ * RENAME_NOREPLACE keeps a name left by another run from being
+ * clobbered. The trash directory is created when missing, and again
+ * if a reclaiming worker removes it between mkdir and rename.
+ *
+ * @param path Target to move.
+ * @param trash Trash directory.
+ * @return 0 on success, -1 on failure (errno set).
+ */
+static int move_to_trash(const char *path, const char *trash) {
+  static unsigned long counter;
+  char dest[PATH_MAX];
+
+  for (int attempt = 0; attempt < 100; attempt++) {
+    if (mkdir(trash, 0700) != 0 && errno != EEXIST) {
+      return -1;
     }
+    snprintf(dest, sizeof(dest), "%s/%ld.%lu", trash, (long)getpid(),
+             counter++);
+    if (renameat2(AT_FDCWD, path, AT_FDCWD, dest, RENAME_NOREPLACE) == 0) {
+      return 0;
+    }
+    if (errno != EEXIST && errno != ENOENT) {
+      return -1;
+    }
+    /* ENOENT is either a vanished trash directory or a missing target */
+    struct stat st;
+    if (errno == ENOENT && lstat(path, &st) != 0) {
+      return -1;
+    }
+  }
+  errno = EEXIST;
+  return -1;
+}
 
-    size_t path_len = strlen(path) + strlen(entry->d_name) + 2;
-    char *full_path = malloc(path_len);
-    if (!full_path) {
-      result = -1;
-      break;
+
+/**
+ * @brief Remembers a trash directory for the background worker.
+ * @param trash Trash directory path.
+ * @param used Trash directories used so far.
+ */
+static void note_trash(const char *trash, rm_trash_t *used) {
+  for (int i = 0; i < used->count; i++) {
+    if (strcmp(used->dirs[i], trash) == 0) return;
+  }
+  if (used->count < RM_MAX_TRASH) {
+    char *copy = strdup(trash);
+    if (copy) used->dirs[used->count++] = copy;
+  }
+}
+
+
+/**
+ * @brief Renames a target into the trash of its filesystem.
+ *
+ * The trash lives at the mount root so one directory serves every
+ * target on the filesystem; where that is not writable, or a bind
+ * mount makes the rename cross devices, a trash beside the target is
+ * used instead. If neither works the target is removed in place.
+ *
+ * @param path Path to remove.
+ * @param recursive If non-zero, recursively remove directories.
+ * @param force If non-zero, ignore nonexistent files.
+ * @param used Trash directories used so far.
+ * @return 0 on success, -1 on failure, -2 if interrupted.
+ */
+static int trash_entry(const char *path, int recursive, int force,
+                       rm_trash_t *used) {
+  struct stat st;
+  if (lstat(path, &st) != 0) {
+    if (force && errno == ENOENT) {
+      return 0;
     }
+    return -1;
+  }
+  if (S_ISDIR(st.st_mode) && !recursive) {
+    errno = EISDIR;
+    return -1;
+  }
 
-    snprintf(full_path, path_len, "%s/%s", path, entry->d_name);
+  char parent[PATH_MAX];
+  snprintf(parent, sizeof(parent), "%s", path);
+  size_t len = strlen(parent);
+  while (len > 1 && parent[len - 1] == '/') parent[--len] = '\0';
+  char *slash = strrchr(parent, '/');
+  if (!slash) {
+    snprintf(parent, sizeof(parent), ".");
+  } else if (slash == parent) {
+    parent[1] = '\0';
+  } else {
+    *slash = '\0';
+  }
 
-    if (remove_entry(full_path, 1, 0) != 0) {
-      result = -1;
+  char root[PATH_MAX];
+  char trash[PATH_MAX + sizeof(RM_TRASH_NAME) + 1];
+  if (find_mount_root(parent, root, sizeof(root)) == 0) {
+    snprintf(trash, sizeof(trash), "%s%s" RM_TRASH_NAME, root,
+             strcmp(root, "/") == 0 ? "" : "/");
+    if (move_to_trash(path, trash) == 0) {
+      note_trash(trash, used);
+      return 0;
     }
+    if (errno != EACCES && errno != EPERM && errno != EROFS
+        && errno != EXDEV) {
+      return -1;
+    }
+  }
 
-    free(full_path);
+  snprintf(trash, sizeof(trash), "%s/" RM_TRASH_NAME, parent);
+  if (move_to_trash(path, trash) == 0) {
+    note_trash(trash, used);
+    return 0;
   }
+  return remove_entry(path, recursive, force);
+}
 
-  closedir(dir);
 
-  if (result == 0) {
-    result = rmdir(path);
+/**
+ * @brief Empties and removes the trash directories.
+ *
+ * Every entry is removed, including those left by earlier runs that
+ * were cut short. Entries another worker removes first are skipped.
+ *
+ * @param used Trash directories to reclaim.
+ */
+static void reclaim_trash(const rm_trash_t *used) {
+  for (int i = 0; i < used->count; i++) {
+    DIR *dir = opendir(used->dirs[i]);
+    if (!dir) continue;
+    struct dirent *ent;
+    char path[PATH_MAX];
+    while ((ent = readdir(dir)) != NULL) {
+      if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+        continue;
+      }
+      snprintf(path, sizeof(path), "%s/%s", used->dirs[i], ent->d_name);
+      jbox_remove_tree(path);
+    }
+    closedir(dir);
+    rmdir(used->dirs[i]);
   }
+}
 
-  return result;
+
+/**
+ * @brief Drops the calling thread to idle I/O and CPU priority.
+ *
+ * Threads it starts inherit both, so the parallel removal workers
+ * only use the disk when nothing else does.
+ */
+static void lower_priority(void) {
+  syscall(SYS_ioprio_set, RM_IOPRIO_WHO_PROCESS, 0,
+          RM_IOPRIO_CLASS_IDLE << RM_IOPRIO_CLASS_SHIFT);
+  setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19);
+}
+
+
+/**
+ * @brief Background worker thread for a hosted rm.
+ * @param arg Heap-allocated rm_trash_t, freed here.
+ * @return NULL.
+ */
+static void *reclaim_thread(void *arg) {
+  rm_trash_t *used = arg;
+  lower_priority();
+  reclaim_trash(used);
+  for (int i = 0; i < used->count; i++) free(used->dirs[i]);
+  free(used);
+  return NULL;
+}
+
+
+/**
+ * @brief Starts deleting the trash without waiting for it.
+ *
+ * A standalone rm forks a detached child so the command returns at
+ * once; inside the shell a detached thread does the work, as a fork
+ * would copy the whole shell.
+ *
+ * @param used Trash directories to reclaim; ownership passes here.
+ */
+static void start_reclaim(rm_trash_t *used) {
+  if (jbox_ctx_is_hosted()) {
+    rm_trash_t *copy = malloc(sizeof(*copy));
+    pthread_t thread;
+    if (copy) {
+      *copy = *used;
+      pthread_attr_t attr;
+      pthread_attr_init(&attr);
+      pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+      int rc = pthread_create(&thread, &attr, reclaim_thread, copy);
+      pthread_attr_destroy(&attr);
+      if (rc == 0) {
+        used->count = 0;
+        return;
+      }
+      free(copy);
+    }
+  } else {
+    fflush(jbox_stdout());
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0) {
+      /* Out of the caller's session and off its pipes */
+      setsid();
+      int null_fd = open("/dev/null", O_RDWR);
+      if (null_fd >= 0) {
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        if (null_fd > STDERR_FILENO) close(null_fd);
+      }
+      lower_priority();
+      reclaim_trash(used);
+      _exit(0);
+    }
+    if (pid > 0) {
+      for (int i = 0; i < used->count; i++) free(used->dirs[i]);
+      used->count = 0;
+      return;
+    }
+  }
+  /* No worker: reclaim in the foreground rather than leak the trash */
+  reclaim_trash(used);
+  for (int i = 0; i < used->count; i++) free(used->dirs[i]);
+  used->count = 0;
 }
 
 
@@ -195,29 +475,34 @@ static int remove_directory_recursive(const char *path) {
  * @param force If non-zero, ignore nonexistent files.
  * @param show_json If non-zero, output in JSON format.
  * @param first_entry Pointer to flag tracking first JSON entry.
- * @return 0 on success, non-zero on failure.
+ * @param trash Trash directories used so far, or NULL to remove in place.
+ * @return 0 on success, -1 on failure, -2 if interrupted.
  */
 static int rm_file(const char *path, int recursive, int force, int show_json,
-                   int *first_entry) {
-  int result = remove_entry(path, recursive, force);
+                   int *first_entry, rm_trash_t *trash) {
+  int result = trash ? trash_entry(path, recursive, force, trash)
+                     : remove_entry(path, recursive, force);
+  if (result == -2) {
+    return -2;
+  }
 
   if (show_json) {
     char escaped_path[512];
     escape_json_string(path, escaped_path, sizeof(escaped_path));
 
     if (!*first_entry) {
-      printf(",\n");
+      jbox_printf(",\n");
     }
     *first_entry = 0;
 
     if (result == 0) {
-      printf("{\"path\": \"%s\", \"status\": \"ok\"}", escaped_path);
+      jbox_printf("{\"path\": \"%s\", \"status\": \"ok\"}", escaped_path);
     } else {
       char escaped_error[256];
       escape_json_string(strerror(errno), escaped_error,
                          sizeof(escaped_error));
-      printf("{\"path\": \"%s\", \"status\": \"error\", \"message\": \"%s\"}",
-             escaped_path, escaped_error);
+      jbox_printf("{\"path\": \"%s\", \"status\": \"error\", "
+                  "\"message\": \"%s\"}", escaped_path, escaped_error);
     }
   } else {
     if (result != 0) {
@@ -241,16 +526,19 @@ static int rm_file(const char *path, int recursive, int force, int show_json,
  * @brief Main entry point for the rm command.
  * @param argc Argument count.
  * @param argv Argument vector.
- * @return 0 on success, 1 on failure.
+ * @return 0 on success, 1 on failure, 130 if interrupted.
  */
 static int rm_run(int argc, char **argv) {
   rm_args_t args;
   build_rm_argtable(&args);
 
+  /* Set up signal handler for clean interrupt */
+  jbox_setup_sigint_handler();
+
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    rm_print_usage(stdout);
+    rm_print_usage(jbox_stdout());
     cleanup_rm_argtable(&args);
     return 0;
   }
@@ -265,22 +553,33 @@ static int rm_run(int argc, char **argv) {
   int recursive = args.recursive->count > 0;
   int force = args.force->count > 0;
   int show_json = args.json->count > 0;
+  int async = args.async->count > 0;
+  rm_trash_t trash = {0};
   int first_entry = 1;
   int result = 0;
 
   if (show_json) {
-    printf("[\n");
+    jbox_printf("[\n");
   }
 
   for (int i = 0; i < args.files->count; i++) {
-    if (rm_file(args.files->filename[i], recursive, force, show_json,
-                &first_entry) != 0) {
+    int status = rm_file(args.files->filename[i], recursive, force,
+                         show_json, &first_entry, async ? &trash : NULL);
+    if (status == -2) {
+      result = 130;  /* 128 + SIGINT(2) */
+      break;
+    }
+    if (status != 0) {
       result = 1;
     }
   }
 
   if (show_json) {
-    printf("\n]\n");
+    jbox_printf("\n]\n");
+  }
+
+  if (trash.count > 0) {
+    start_reclaim(&trash);
   }
 
   cleanup_rm_argtable(&args);
@@ -296,10 +595,14 @@ const jshell_cmd_spec_t cmd_rm_spec = {
   .summary = "remove files or directories",
   .long_help = "Remove (unlink) the FILE(s). "
                "With -r, remove directories and their contents recursively. "
-               "With -f, ignore nonexistent files and never prompt.",
+               "With -f, ignore nonexistent files and never prompt. "
+               "With --async, rename targets into a .jbox-trash directory "
+               "on their filesystem, return at once and delete them on a "
+               "background worker at idle I/O priority.",
   .type = CMD_EXTERNAL,
   .run = rm_run,
-  .print_usage = rm_print_usage
+  .print_usage = rm_print_usage,
+  .describe_args = rm_describe_args
 };
 
 
@@ -10,6 +10,7 @@
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_ctx.h"
 
 
 /**
@@ -67,6 +68,22 @@ static void rmdir_print_usage(FILE *out) {
 }
 
 
+/**
+ * @brief Passes the rmdir argtable to visit, for tool
+ *        schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void rmdir_describe_args(jshell_argtable_visit_fn visit,
+                                void *userdata) {
+  rmdir_args_t args;
+  build_rmdir_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_rmdir_argtable(&args);
+}
+
+
 /**
  * @brief Escapes special characters in a string for JSON output.
  * @param str Input string to escape.
@@ -116,18 +133,18 @@ static int remove_dir(const char *path, int show_json, int *first_entry) {
     escape_json_string(path, escaped_path, sizeof(escaped_path));
 
     if (!*first_entry) {
-      printf(",\n");
+      jbox_printf(",\n");
     }
     *first_entry = 0;
 
     if (result == 0) {
-      printf("{\"path\": \"%s\", \"status\": \"ok\"}", escaped_path);
+      jbox_printf("{\"path\": \"%s\", \"status\": \"ok\"}", escaped_path);
     } else {
       char escaped_error[256];
       escape_json_string(strerror(errno), escaped_error,
                          sizeof(escaped_error));
-      printf("{\"path\": \"%s\", \"status\": \"error\", \"message\": \"%s\"}",
-             escaped_path, escaped_error);
+      jbox_printf("{\"path\": \"%s\", \"status\": \"error\", "
+                  "\"message\": \"%s\"}", escaped_path, escaped_error);
     }
   } else {
     if (result != 0) {
@@ -153,7 +170,7 @@ static int rmdir_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    rmdir_print_usage(stdout);
+    rmdir_print_usage(jbox_stdout());
     cleanup_rmdir_argtable(&args);
     return 0;
   }
@@ -170,7 +187,7 @@ static int rmdir_run(int argc, char **argv) {
   int result = 0;
 
   if (show_json) {
-    printf("[\n");
+    jbox_printf("[\n");
   }
 
   for (int i = 0; i < args.dirs->count; i++) {
@@ -180,7 +197,7 @@ static int rmdir_run(int argc, char **argv) {
   }
 
   if (show_json) {
-    printf("\n]\n");
+    jbox_printf("\n]\n");
   }
 
   cleanup_rmdir_argtable(&args);
@@ -197,7 +214,8 @@ const jshell_cmd_spec_t cmd_rmdir_spec = {
   .long_help = "Remove the DIRECTORY(ies), if they are empty.",
   .type = CMD_EXTERNAL,
   .run = rmdir_run,
-  .print_usage = rmdir_print_usage
+  .print_usage = rmdir_print_usage,
+  .describe_args = rmdir_describe_args
 };
 
 
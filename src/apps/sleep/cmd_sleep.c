@@ -10,6 +10,7 @@
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_ctx.h"
 
 
 /**
@@ -67,6 +68,21 @@ static void sleep_print_usage(FILE *out) {
 }
 
 
+/**
+ * Passes the sleep argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void sleep_describe_args(jshell_argtable_visit_fn visit,
+                                void *userdata) {
+  sleep_args_t args;
+  build_sleep_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_sleep_argtable(&args);
+}
+
+
 /**
  * Execute the sleep command.
  * @param argc Argument count.
@@ -80,7 +96,7 @@ static int sleep_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    sleep_print_usage(stdout);
+    sleep_print_usage(jbox_stdout());
     cleanup_sleep_argtable(&args);
     return 0;
   }
@@ -125,7 +141,8 @@ const jshell_cmd_spec_t cmd_sleep_spec = {
                "floating point number to specify fractional seconds.",
   .type = CMD_EXTERNAL,
   .run = sleep_run,
-  .print_usage = sleep_print_usage
+  .print_usage = sleep_print_usage,
+  .describe_args = sleep_describe_args
 };
 
 
@@ -0,0 +1,1303 @@
+/**
+ * @file cmd_sort.c
+ * @brief Sort command implementation for jshell.
+ *
+ * Input lines are copied into one text buffer and described by small
+ * records holding their offsets and the span of their first key, so
+ * sorting moves records and never text. Unless that key is numeric the
+ * record also holds its first eight bytes as an integer, which settles
+ * most comparisons without reading the lines at all. Once text and
+ * records reach the --buffer-size budget the chunk is sorted and written
+ * to an unlinked temporary file as a sorted run, and the buffer is
+ * reused. A chunk is sorted by splitting it among the threads, merge
+ * sorting each share, and merging the shares pairwise, a thread per pair.
+ *
+ * At the end of input a chunk that never spilled is printed directly;
+ * otherwise the runs and the last chunk, still in memory, are merged
+ * through a heap, at most SORT_MERGE_WAYS at a time so descriptors and
+ * read buffers stay bounded however large the input is.
+ *
+ * Comparisons are by bytes, as in the C locale. -n compares the digits
+ * of the numbers as text, so any length of number orders exactly.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "argtable3.h"
+#include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_ctx.h"
+#include "utils/jbox_linereader.h"
+#include "utils/jbox_signals.h"
+
+
+/** Default --buffer-size */
+#define SORT_BUFFER_DEFAULT (256ULL * 1024 * 1024)
+
+/** Smallest budget honoured, so a tiny -S still makes progress */
+#define SORT_BUFFER_MIN (64 * 1024)
+
+/** Most sources merged at once */
+#define SORT_MERGE_WAYS 64
+
+/** Upper bound on sorting threads */
+#define SORT_MAX_WORKERS 16
+
+/** Chunks with fewer lines are sorted on one thread */
+#define SORT_PARALLEL_MIN 65536
+
+/** Ranges this short are insertion sorted */
+#define SORT_INSERTION_MAX 16
+
+
+/** One -k key: fields and characters count from 1; an end field of 0
+ *  is the end of the line, an end character of 0 the end of its field */
+typedef struct {
+  size_t start_field;
+  size_t start_char;
+  size_t end_field;
+  size_t end_char;
+  int numeric;
+  int reverse;
+  int skip_blanks;
+} sort_key_t;
+
+/** How lines compare */
+typedef struct {
+  sort_key_t *keys;         /* At least one; the whole line by default */
+  size_t key_count;
+  int tab;                  /* Field separator, or -1 for blank runs */
+  int reverse;              /* Reverse the last-resort comparison */
+  int last_resort;          /* Compare whole lines when keys tie */
+  int prefixed;             /* Records carry the first key's prefix */
+} sort_order_t;
+
+/** A line in a chunk's text; the first key is precomputed */
+typedef struct {
+  size_t off;               /* Start in the text; 0 for a merge head */
+  size_t len;               /* Without the newline */
+  size_t key_off;           /* Start of the first key, from the line */
+  size_t key_len;
+  uint64_t prefix;          /* First key's first 8 bytes, big-endian,
+                               zero padded */
+} sort_line_t;
+
+/** Lines held in memory */
+typedef struct {
+  char *text;               /* Lines, each followed by '\n' */
+  size_t text_len;
+  size_t text_cap;
+  sort_line_t *lines;
+  size_t count;
+  size_t cap;
+  sort_line_t *scratch;     /* Merge space, as long as lines */
+  size_t scratch_cap;
+} sort_chunk_t;
+
+/** One input of a merge: a run on disk or the chunk in memory */
+typedef struct {
+  int fd;                   /* Run, or -1 for the chunk */
+  jbox_linereader_t reader;
+  const sort_chunk_t *chunk;
+  size_t next;
+  const char *line;         /* Current line */
+  sort_line_t rec;
+  size_t index;             /* Position among the sources, for ties */
+} sort_source_t;
+
+/** Everything a sort needs */
+typedef struct {
+  sort_order_t order;
+  int unique;
+  size_t budget;
+  int workers;
+  const char *tmpdir;
+  sort_chunk_t chunk;
+  int *runs;                /* Descriptors of unlinked sorted runs */
+  size_t run_count;
+  size_t run_cap;
+} sort_state_t;
+
+/** A range for a thread to sort or merge */
+typedef struct {
+  const sort_order_t *order;
+  const char *text;
+  sort_line_t *lines;
+  sort_line_t *scratch;
+  size_t left;              /* Lines in the first sorted half, when merging */
+  size_t count;
+} sort_task_t;
+
+
+typedef struct {
+  struct arg_lit *help;
+  struct arg_lit *numeric;
+  struct arg_lit *reverse;
+  struct arg_lit *unique;
+  struct arg_str *keys;
+  struct arg_str *separator;
+  struct arg_str *buffer_size;
+  struct arg_int *parallel;
+  struct arg_str *tmpdir;
+  struct arg_file *files;
+  struct arg_end *end;
+  void *argtable[11];
+} sort_args_t;
+
+
+/**
+ * Build the argument table for the sort command.
+ * @param args Pointer to sort_args_t structure to populate.
+ */
+static void build_sort_argtable(sort_args_t *args) {
+  args->help        = arg_lit0("h", "help", "display this help and exit");
+  args->numeric     = arg_lit0("n", "numeric-sort",
+                               "compare by leading numeric value");
+  args->reverse     = arg_lit0("r", "reverse", "reverse the order");
+  args->unique      = arg_lit0("u", "unique",
+                               "print only the first of lines with equal keys");
+  args->keys        = arg_strn("k", "key", "KEYDEF", 0, 16,
+                               "sort by a key: F[.C][bnr][,F[.C][bnr]]");
+  args->separator   = arg_str0("t", "field-separator", "SEP",
+                               "separate fields with SEP instead of blanks");
+  args->buffer_size = arg_str0("S", "buffer-size", "SIZE",
+                               "memory for lines before spilling to disk "
+                               "(K by default; b, K, M, G suffixes)");
+  args->parallel    = arg_int0(NULL, "parallel", "N",
+                               "sort on at most N threads");
+  args->tmpdir      = arg_str0("T", "temporary-directory", "DIR",
+                               "write spilled runs to DIR");
+  args->files       = arg_filen(NULL, NULL, "FILE", 0, 1000,
+                                "files to sort (default: standard input)");
+  args->end         = arg_end(20);
+
+  args->argtable[0] = args->help;
+  args->argtable[1] = args->numeric;
+  args->argtable[2] = args->reverse;
+  args->argtable[3] = args->unique;
+  args->argtable[4] = args->keys;
+  args->argtable[5] = args->separator;
+  args->argtable[6] = args->buffer_size;
+  args->argtable[7] = args->parallel;
+  args->argtable[8] = args->tmpdir;
+  args->argtable[9] = args->files;
+  args->argtable[10] = args->end;
+}
+
+
+/**
+ * Clean up and free the argument table.
+ * @param args Pointer to sort_args_t structure to clean up.
+ */
+static void cleanup_sort_argtable(sort_args_t *args) {
+  arg_freetable(args->argtable,
+                sizeof(args->argtable) / sizeof(args->argtable[0]));
+}
+
+
+/**
+ * Print usage information for the sort command.
+ * @param out Output stream to write usage information to.
+ */
+static void sort_print_usage(FILE *out) {
+  sort_args_t args;
+  build_sort_argtable(&args);
+  fprintf(out, "Usage: sort");
+  arg_print_syntax(out, args.argtable, "\n");
+  fprintf(out, "Write the lines of all FILEs, sorted, to standard "
+               "output.\n\n");
+  fprintf(out, "Options:\n");
+  arg_print_glossary(out, args.argtable, "  %-28s %s\n");
+  cleanup_sort_argtable(&args);
+}
+
+
+/**
+ * Passes the sort argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void sort_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  sort_args_t args;
+  build_sort_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_sort_argtable(&args);
+}
+
+
+/* ---- keys and comparison ---- */
+
+static inline int is_blank(char c) {
+  return c == ' ' || c == '\t';
+}
+
+
+/**
+ * Offset where a field starts. Without a separator a field is a run of
+ * non-blanks together with the blanks before it.
+ */
+static size_t field_start(const char *line, size_t len, int tab,
+                          size_t field) {
+  size_t pos = 0;
+  for (size_t f = 1; f < field && pos < len; f++) {
+    if (tab >= 0) {
+      const char *sep = memchr(line + pos, tab, len - pos);
+      if (!sep) return len;
+      pos = (size_t)(sep - line) + 1;
+    } else {
+      while (pos < len && is_blank(line[pos])) pos++;
+      while (pos < len && !is_blank(line[pos])) pos++;
+    }
+  }
+  return pos;
+}
+
+
+/**
+ * Offset where the field starting at pos ends.
+ */
+static size_t field_end(const char *line, size_t len, int tab, size_t pos) {
+  if (tab >= 0) {
+    const char *sep = memchr(line + pos, tab, len - pos);
+    return sep ? (size_t)(sep - line) : len;
+  }
+  while (pos < len && is_blank(line[pos])) pos++;
+  while (pos < len && !is_blank(line[pos])) pos++;
+  return pos;
+}
+
+
+/**
+ * Find a key in a line.
+ * @param order Field separator.
+ * @param key Key to find.
+ * @param line Line text.
+ * @param len Line length.
+ * @param off Set to the start of the key.
+ * @param key_len Set to the length of the key.
+ */
+static void find_key(const sort_order_t *order, const sort_key_t *key,
+                     const char *line, size_t len, size_t *off,
+                     size_t *key_len) {
+  size_t start = field_start(line, len, order->tab, key->start_field);
+  if (key->skip_blanks) {
+    while (start < len && is_blank(line[start])) start++;
+  }
+  start += key->start_char - 1;
+  if (start > len) start = len;
+
+  size_t end = len;
+  if (key->end_field > 0) {
+    end = field_start(line, len, order->tab, key->end_field);
+    if (key->end_char == 0) {
+      end = field_end(line, len, order->tab, end);
+    } else {
+      if (key->skip_blanks) {
+        while (end < len && is_blank(line[end])) end++;
+      }
+      end += key->end_char;
+      if (end > len) end = len;
+    }
+  }
+  if (end < start) end = start;
+
+  *off = start;
+  *key_len = end - start;
+}
+
+
+/**
+ * Fill in a record's first key.
+ */
+static inline void set_first_key(const sort_order_t *order, const char *line,
+                                 sort_line_t *rec) {
+  find_key(order, &order->keys[0], line, rec->len, &rec->key_off,
+           &rec->key_len);
+  if (order->prefixed) {
+    unsigned char bytes[8] = {0};
+    memcpy(bytes, line + rec->key_off, rec->key_len < 8 ? rec->key_len : 8);
+    uint64_t prefix;
+    memcpy(&prefix, bytes, sizeof(prefix));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    prefix = __builtin_bswap64(prefix);
+#endif
+    rec->prefix = prefix;
+  }
+}
+
+
+/**
+ * Compare byte strings, a shorter prefix first.
+ */
+static inline int compare_bytes(const char *a, size_t a_len,
+                                const char *b, size_t b_len) {
+  int c = memcmp(a, b, a_len < b_len ? a_len : b_len);
+  if (c != 0) return c;
+  return (a_len > b_len) - (a_len < b_len);
+}
+
+
+/** The parts of a number that order it */
+typedef struct {
+  const char *digits;       /* Integer digits, without leading zeros */
+  size_t digit_count;
+  const char *fraction;     /* Fraction digits, without trailing zeros */
+  size_t fraction_count;
+  int negative;
+} sort_number_t;
+
+
+/**
+ * Split the number at the start of text: blanks, an optional '-',
+ * digits, and an optional '.' with more digits. Anything else is 0.
+ */
+static void parse_number(const char *s, size_t len, sort_number_t *num) {
+  size_t i = 0;
+  while (i < len && is_blank(s[i])) i++;
+  num->negative = i < len && s[i] == '-';
+  if (num->negative) i++;
+  while (i < len && s[i] == '0') i++;
+
+  num->digits = s + i;
+  while (i < len && isdigit((unsigned char)s[i])) i++;
+  num->digit_count = (size_t)(s + i - num->digits);
+
+  num->fraction = s + i;
+  num->fraction_count = 0;
+  if (i < len && s[i] == '.') {
+    num->fraction = s + ++i;
+    while (i < len && isdigit((unsigned char)s[i])) i++;
+    num->fraction_count = (size_t)(s + i - num->fraction);
+    while (num->fraction_count > 0 &&
+           num->fraction[num->fraction_count - 1] == '0') {
+      num->fraction_count--;
+    }
+  }
+  if (num->digit_count == 0 && num->fraction_count == 0) {
+    num->negative = 0;      /* -0 is 0 */
+  }
+}
+
+
+/**
+ * Compare the leading numbers of two strings exactly.
+ */
+static int compare_numbers(const char *a, size_t a_len,
+                           const char *b, size_t b_len) {
+  sort_number_t x, y;
+  parse_number(a, a_len, &x);
+  parse_number(b, b_len, &y);
+  if (x.negative != y.negative) return x.negative ? -1 : 1;
+
+  int c;
+  if (x.digit_count != y.digit_count) {
+    c = x.digit_count < y.digit_count ? -1 : 1;
+  } else {
+    c = memcmp(x.digits, y.digits, x.digit_count);
+    if (c == 0) {
+      c = compare_bytes(x.fraction, x.fraction_count,
+                        y.fraction, y.fraction_count);
+    }
+  }
+  return x.negative ? -c : c;
+}
+
+
+/**
+ * Compare one key of two lines.
+ */
+static inline int compare_key(const sort_key_t *key, const char *a,
+                              size_t a_len, const char *b, size_t b_len) {
+  int c = key->numeric ? compare_numbers(a, a_len, b, b_len)
+                       : compare_bytes(a, a_len, b, b_len);
+  return key->reverse ? -c : c;
+}
+
+
+/**
+ * Compare two lines by every key, then as a last resort by all of them.
+ * @param order Keys and flags.
+ * @param a Text of the first line.
+ * @param ra Its record.
+ * @param b Text of the second line.
+ * @param rb Its record.
+ * @return Negative, zero or positive, as strcmp()
+ */
+static int compare_lines(const sort_order_t *order,
+                         const char *a, const sort_line_t *ra,
+                         const char *b, const sort_line_t *rb) {
+  /* Padding sorts below every byte, so differing prefixes decide the
+   * order without touching the lines */
+  if (order->prefixed && ra->prefix != rb->prefix) {
+    int c = ra->prefix < rb->prefix ? -1 : 1;
+    return order->keys[0].reverse ? -c : c;
+  }
+  int c = compare_key(&order->keys[0], a + ra->key_off, ra->key_len,
+                      b + rb->key_off, rb->key_len);
+  if (c != 0) return c;
+
+  for (size_t i = 1; i < order->key_count; i++) {
+    size_t a_off, a_len, b_off, b_len;
+    find_key(order, &order->keys[i], a, ra->len, &a_off, &a_len);
+    find_key(order, &order->keys[i], b, rb->len, &b_off, &b_len);
+    c = compare_key(&order->keys[i], a + a_off, a_len, b + b_off, b_len);
+    if (c != 0) return c;
+  }
+
+  if (!order->last_resort) return 0;
+  c = compare_bytes(a, ra->len, b, rb->len);
+  return order->reverse ? -c : c;
+}
+
+
+/* ---- sorting a chunk ---- */
+
+static inline int record_less_equal(const sort_task_t *t,
+                                    const sort_line_t *a,
+                                    const sort_line_t *b) {
+  return compare_lines(t->order, t->text + a->off, a,
+                       t->text + b->off, b) <= 0;
+}
+
+
+/**
+ * Merge lines[0, left) and lines[left, count), both sorted, in place,
+ * through scratch. Equal lines keep their order.
+ */
+static void merge_halves(const sort_task_t *t, sort_line_t *lines,
+                         sort_line_t *scratch, size_t left, size_t count) {
+  if (left == 0 || left == count ||
+      record_less_equal(t, &lines[left - 1], &lines[left])) {
+    return;
+  }
+  memcpy(scratch, lines, left * sizeof(sort_line_t));
+
+  size_t i = 0, j = left, k = 0;
+  while (i < left && j < count) {
+    if (record_less_equal(t, &scratch[i], &lines[j])) {
+      lines[k++] = scratch[i++];
+    } else {
+      lines[k++] = lines[j++];
+    }
+  }
+  while (i < left) lines[k++] = scratch[i++];
+}
+
+
+/**
+ * Merge sort lines, stably.
+ */
+static void merge_sort(const sort_task_t *t, sort_line_t *lines,
+                       sort_line_t *scratch, size_t count) {
+  if (count <= SORT_INSERTION_MAX) {
+    for (size_t i = 1; i < count; i++) {
+      sort_line_t rec = lines[i];
+      size_t j = i;
+      while (j > 0 && !record_less_equal(t, &lines[j - 1], &rec)) {
+        lines[j] = lines[j - 1];
+        j--;
+      }
+      lines[j] = rec;
+    }
+    return;
+  }
+  size_t left = count / 2;
+  merge_sort(t, lines, scratch, left);
+  merge_sort(t, lines + left, scratch + left, count - left);
+  merge_halves(t, lines, scratch, left, count);
+}
+
+
+static void *sort_share(void *arg) {
+  sort_task_t *t = arg;
+  merge_sort(t, t->lines, t->scratch, t->count);
+  return NULL;
+}
+
+
+static void *merge_shares(void *arg) {
+  sort_task_t *t = arg;
+  merge_halves(t, t->lines, t->scratch, t->left, t->count);
+  return NULL;
+}
+
+
+/**
+ * Run each task on its own thread, the last on this one; a task whose
+ * thread cannot be started runs here too.
+ */
+static void run_tasks(sort_task_t *tasks, int count, void *(*fn)(void *)) {
+  pthread_t threads[SORT_MAX_WORKERS];
+  int started[SORT_MAX_WORKERS] = {0};
+  for (int i = 0; i < count - 1; i++) {
+    started[i] = pthread_create(&threads[i], NULL, fn, &tasks[i]) == 0;
+    if (!started[i]) fn(&tasks[i]);
+  }
+  fn(&tasks[count - 1]);
+  for (int i = 0; i < count - 1; i++) {
+    if (started[i]) pthread_join(threads[i], NULL);
+  }
+}
+
+
+/**
+ * Sort a chunk's lines, on several threads when it is large: each sorts
+ * a share, then shares are merged pairwise until one is left.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int sort_chunk(sort_state_t *state) {
+  sort_chunk_t *chunk = &state->chunk;
+  if (chunk->count < 2) return 0;
+  if (chunk->scratch_cap < chunk->count) {
+    sort_line_t *grown = realloc(chunk->scratch,
+                                 chunk->cap * sizeof(sort_line_t));
+    if (!grown) return -1;
+    chunk->scratch = grown;
+    chunk->scratch_cap = chunk->cap;
+  }
+
+  int shares = state->workers;
+  if (chunk->count < SORT_PARALLEL_MIN) shares = 1;
+
+  sort_task_t tasks[SORT_MAX_WORKERS];
+  size_t bounds[SORT_MAX_WORKERS + 1];
+  for (int i = 0; i <= shares; i++) {
+    bounds[i] = chunk->count * (size_t)i / (size_t)shares;
+  }
+  for (int i = 0; i < shares; i++) {
+    tasks[i] = (sort_task_t){
+      .order = &state->order,
+      .text = chunk->text,
+      .lines = chunk->lines + bounds[i],
+      .scratch = chunk->scratch + bounds[i],
+      .count = bounds[i + 1] - bounds[i],
+    };
+  }
+  run_tasks(tasks, shares, sort_share);
+
+  /* Merge neighbouring shares until one covers everything */
+  for (int width = 1; width < shares; width *= 2) {
+    int pairs = 0;
+    for (int i = 0; i + width < shares; i += 2 * width) {
+      int end = i + 2 * width < shares ? i + 2 * width : shares;
+      tasks[pairs++] = (sort_task_t){
+        .order = &state->order,
+        .text = chunk->text,
+        .lines = chunk->lines + bounds[i],
+        .scratch = chunk->scratch + bounds[i],
+        .left = bounds[i + width] - bounds[i],
+        .count = bounds[end] - bounds[i],
+      };
+    }
+    run_tasks(tasks, pairs, merge_shares);
+  }
+  return 0;
+}
+
+
+/* ---- reading input ---- */
+
+/**
+ * Memory the chunk holds for its lines: text, records and merge space.
+ */
+static size_t chunk_size(const sort_chunk_t *chunk) {
+  return chunk->text_len + chunk->count * 2 * sizeof(sort_line_t);
+}
+
+
+/**
+ * Copy a line into the chunk.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int add_line(sort_state_t *state, const char *line, size_t len) {
+  sort_chunk_t *chunk = &state->chunk;
+
+  if (chunk->text_len + len + 1 > chunk->text_cap) {
+    size_t need = chunk->text_len + len + 1;
+    size_t cap = chunk->text_cap ? chunk->text_cap : 64 * 1024;
+    while (cap < need) cap *= 2;
+    /* Doubling past the budget would only hold text that spills first */
+    if (cap > state->budget && need <= state->budget) cap = state->budget;
+    char *grown = realloc(chunk->text, cap);
+    if (!grown) return -1;
+    chunk->text = grown;
+    chunk->text_cap = cap;
+  }
+  if (chunk->count >= chunk->cap) {
+    size_t cap = chunk->cap ? chunk->cap * 2 : 4096;
+    sort_line_t *grown = realloc(chunk->lines, cap * sizeof(sort_line_t));
+    if (!grown) return -1;
+    chunk->lines = grown;
+    chunk->cap = cap;
+  }
+
+  char *copy = chunk->text + chunk->text_len;
+  memcpy(copy, line, len);
+  copy[len] = '\n';
+  sort_line_t *rec = &chunk->lines[chunk->count++];
+  rec->off = chunk->text_len;
+  rec->len = len;
+  set_first_key(&state->order, copy, rec);
+  chunk->text_len += len + 1;
+  return 0;
+}
+
+
+/**
+ * Write a chunk's sorted lines, dropping repeats with -u.
+ * @return 0 on success, -1 on write error.
+ */
+static int write_chunk(const sort_state_t *state, FILE *out) {
+  const sort_chunk_t *chunk = &state->chunk;
+  const sort_line_t *prev = NULL;
+  for (size_t i = 0; i < chunk->count; i++) {
+    const sort_line_t *rec = &chunk->lines[i];
+    if (state->unique && prev &&
+        compare_lines(&state->order, chunk->text + prev->off, prev,
+                      chunk->text + rec->off, rec) == 0) {
+      continue;
+    }
+    fwrite(chunk->text + rec->off, 1, rec->len + 1, out);
+    prev = rec;
+  }
+  return ferror(out) ? -1 : 0;
+}
+
+
+/**
+ * Make an unlinked temporary file for a run.
+ * @return Its descriptor, or -1 (errno set).
+ */
+static int make_run_file(const sort_state_t *state) {
+  size_t len = strlen(state->tmpdir) + sizeof("/sort-XXXXXX");
+  char *path = malloc(len);
+  if (!path) return -1;
+  snprintf(path, len, "%s/sort-XXXXXX", state->tmpdir);
+  int fd = mkostemp(path, O_CLOEXEC);
+  if (fd >= 0) unlink(path);
+  int saved = errno;
+  free(path);
+  errno = saved;
+  return fd;
+}
+
+
+/**
+ * Remember a run's descriptor.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int add_run(sort_state_t *state, int fd) {
+  if (state->run_count >= state->run_cap) {
+    size_t cap = state->run_cap ? state->run_cap * 2 : 16;
+    int *grown = realloc(state->runs, cap * sizeof(int));
+    if (!grown) return -1;
+    state->runs = grown;
+    state->run_cap = cap;
+  }
+  state->runs[state->run_count++] = fd;
+  return 0;
+}
+
+
+/**
+ * Open a FILE on a new run file.
+ * @return The stream, or NULL with an error printed.
+ */
+static FILE *open_run(sort_state_t *state) {
+  int fd = make_run_file(state);
+  if (fd < 0) {
+    fprintf(stderr, "sort: cannot create temporary file in '%s': %s\n",
+            state->tmpdir, strerror(errno));
+    return NULL;
+  }
+  int keep = dup(fd);
+  FILE *out = keep >= 0 ? fdopen(fd, "w") : NULL;
+  if (!out || add_run(state, keep) != 0) {
+    fprintf(stderr, "sort: %s\n", strerror(errno ? errno : ENOMEM));
+    if (out) fclose(out); else close(fd);
+    if (keep >= 0) close(keep);
+    return NULL;
+  }
+  return out;
+}
+
+
+/**
+ * Close a run being written, reporting a failed write.
+ * @return 0 on success, -1 on error (printed).
+ */
+static int close_run(FILE *out, int failed) {
+  if (fclose(out) != 0) failed = 1;
+  if (failed) {
+    fprintf(stderr, "sort: write failed: %s\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+
+/**
+ * Sort the chunk, write it out as a run, and empty it.
+ * @return 0 on success, -1 on error (printed).
+ */
+static int spill_chunk(sort_state_t *state) {
+  if (sort_chunk(state) != 0) {
+    fprintf(stderr, "sort: out of memory\n");
+    return -1;
+  }
+  FILE *out = open_run(state);
+  if (!out) return -1;
+  int failed = write_chunk(state, out) != 0;
+  if (close_run(out, failed) != 0) return -1;
+
+  state->chunk.text_len = 0;
+  state->chunk.count = 0;
+  return 0;
+}
+
+
+/**
+ * Read every line of a descriptor into the chunk, spilling as the
+ * budget fills.
+ * @return 0 on success, -1 on error (printed), -2 on interrupt.
+ */
+static int read_input(sort_state_t *state, int fd, const char *name) {
+  jbox_linereader_t reader;
+  if (jbox_linereader_init(&reader, fd) != 0) {
+    fprintf(stderr, "sort: out of memory\n");
+    return -1;
+  }
+
+  int rc = 0;
+  char *line;
+  size_t len;
+  for (;;) {
+    int got = jbox_linereader_next(&reader, &line, &len);
+    if (got != 1) {
+      if (got == -1) {
+        fprintf(stderr, "sort: read failed: %s: %s\n", name,
+                strerror(errno));
+      }
+      rc = got;
+      break;
+    }
+    if (add_line(state, line, len) != 0) {
+      fprintf(stderr, "sort: out of memory\n");
+      rc = -1;
+      break;
+    }
+    if (chunk_size(&state->chunk) >= state->budget) {
+      if (jbox_is_interrupted()) {
+        rc = -2;
+        break;
+      }
+      if (spill_chunk(state) != 0) {
+        rc = -1;
+        break;
+      }
+    }
+  }
+  jbox_linereader_free(&reader);
+  return rc;
+}
+
+
+/* ---- merging ---- */
+
+/**
+ * Move a source to its next line.
+ * @return 1 if it has one, 0 at its end, -1 on error, -2 on interrupt.
+ */
+static int source_advance(const sort_state_t *state, sort_source_t *src) {
+  if (src->fd < 0) {
+    const sort_chunk_t *chunk = src->chunk;
+    if (src->next >= chunk->count) return 0;
+    src->rec = chunk->lines[src->next++];
+    src->line = chunk->text + src->rec.off;
+    src->rec.off = 0;
+    return 1;
+  }
+
+  char *line;
+  size_t len;
+  int rc = jbox_linereader_next(&src->reader, &line, &len);
+  if (rc != 1) return rc;
+  src->line = line;
+  src->rec = (sort_line_t){ .off = 0, .len = len };
+  set_first_key(&state->order, line, &src->rec);
+  return 1;
+}
+
+
+/**
+ * Whether a source's line goes before another's; ties go to the earlier
+ * source, which holds earlier input.
+ */
+static inline int source_before(const sort_order_t *order,
+                                const sort_source_t *a,
+                                const sort_source_t *b) {
+  int c = compare_lines(order, a->line, &a->rec, b->line, &b->rec);
+  return c < 0 || (c == 0 && a->index < b->index);
+}
+
+
+/**
+ * Restore the heap below position i.
+ */
+static void heap_down(const sort_order_t *order, sort_source_t **heap,
+                      size_t count, size_t i) {
+  for (;;) {
+    size_t least = i;
+    size_t l = 2 * i + 1;
+    size_t r = l + 1;
+    if (l < count && source_before(order, heap[l], heap[least])) least = l;
+    if (r < count && source_before(order, heap[r], heap[least])) least = r;
+    if (least == i) return;
+    sort_source_t *tmp = heap[i];
+    heap[i] = heap[least];
+    heap[least] = tmp;
+    i = least;
+  }
+}
+
+
+/** The last line written, kept for -u */
+typedef struct {
+  char *text;
+  size_t cap;
+  sort_line_t rec;
+  int valid;
+} sort_prev_t;
+
+
+/**
+ * Merge sources into out, closing the runs among them.
+ * @param state Sort state.
+ * @param sources Sources, runs open, in input order.
+ * @param count Number of sources.
+ * @param out Stream to write to.
+ * @return 0 on success, -1 on error (printed), -2 on interrupt.
+ */
+static int merge_sources(const sort_state_t *state, sort_source_t *sources,
+                         size_t count, FILE *out) {
+  const sort_order_t *order = &state->order;
+  sort_source_t **heap = calloc(count, sizeof(*heap));
+  sort_prev_t prev = {0};
+  int rc = 0;
+  if (!heap) {
+    fprintf(stderr, "sort: out of memory\n");
+    rc = -1;
+  }
+
+  size_t live = 0;
+  for (size_t i = 0; i < count && rc == 0; i++) {
+    sources[i].index = i;
+    if (sources[i].fd >= 0) {
+      if (lseek(sources[i].fd, 0, SEEK_SET) != 0 ||
+          jbox_linereader_init(&sources[i].reader, sources[i].fd) != 0) {
+        fprintf(stderr, "sort: %s\n", strerror(errno));
+        rc = -1;
+        break;
+      }
+    }
+    int got = source_advance(state, &sources[i]);
+    if (got < 0) rc = got;
+    if (got == 1) heap[live++] = &sources[i];
+  }
+  for (size_t i = live / 2; i-- > 0;) {
+    heap_down(order, heap, live, i);
+  }
+
+  size_t written = 0;
+  while (rc == 0 && live > 0) {
+    sort_source_t *top = heap[0];
+
+    if (!state->unique || !prev.valid ||
+        compare_lines(order, prev.text, &prev.rec, top->line,
+                      &top->rec) != 0) {
+      fwrite(top->line, 1, top->rec.len, out);
+      putc('\n', out);
+      if (state->unique) {
+        if (prev.cap < top->rec.len + 1) {
+          char *grown = realloc(prev.text, top->rec.len + 1);
+          if (!grown) {
+            fprintf(stderr, "sort: out of memory\n");
+            rc = -1;
+            break;
+          }
+          prev.text = grown;
+          prev.cap = top->rec.len + 1;
+        }
+        memcpy(prev.text, top->line, top->rec.len);
+        prev.rec = top->rec;
+        prev.valid = 1;
+      }
+    }
+    if ((++written & 0xffff) == 0 && jbox_is_interrupted()) {
+      rc = -2;
+      break;
+    }
+
+    int got = source_advance(state, top);
+    if (got < 0) {
+      rc = got;
+      if (got == -1) {
+        fprintf(stderr, "sort: read failed: %s\n", strerror(errno));
+      }
+      break;
+    }
+    if (got == 0) heap[0] = heap[--live];
+    heap_down(order, heap, live, 0);
+  }
+  if (rc == 0 && ferror(out)) {
+    fprintf(stderr, "sort: write failed: %s\n", strerror(errno));
+    rc = -1;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    if (sources[i].fd >= 0) {
+      if (sources[i].reader.buf) jbox_linereader_free(&sources[i].reader);
+      close(sources[i].fd);
+    }
+  }
+  free(prev.text);
+  free(heap);
+  return rc;
+}
+
+
+/**
+ * Merge the runs, and the chunk if it holds lines, to out; first
+ * merging runs into fewer, longer runs while there are too many to
+ * merge at once.
+ * @return 0 on success, -1 on error (printed), -2 on interrupt.
+ */
+static int merge_all(sort_state_t *state, FILE *out) {
+  sort_source_t sources[SORT_MERGE_WAYS];
+  int with_chunk = state->chunk.count > 0;
+
+  while (state->run_count + (size_t)with_chunk > SORT_MERGE_WAYS) {
+    /* Oldest runs first, so earlier input stays ahead on ties */
+    memset(sources, 0, sizeof(sources));
+    for (size_t i = 0; i < SORT_MERGE_WAYS; i++) {
+      sources[i].fd = state->runs[i];
+    }
+    state->run_count -= SORT_MERGE_WAYS;
+    memmove(state->runs, state->runs + SORT_MERGE_WAYS,
+            state->run_count * sizeof(int));
+
+    FILE *merged = open_run(state);
+    if (!merged) {
+      for (size_t i = 0; i < SORT_MERGE_WAYS; i++) close(sources[i].fd);
+      return -1;
+    }
+    /* The merged run holds the oldest input, so it goes first */
+    int merged_fd = state->runs[state->run_count - 1];
+    memmove(state->runs + 1, state->runs,
+            (state->run_count - 1) * sizeof(int));
+    state->runs[0] = merged_fd;
+
+    int rc = merge_sources(state, sources, SORT_MERGE_WAYS, merged);
+    int closed = close_run(merged, 0);
+    if (rc != 0) return rc;
+    if (closed != 0) return -1;
+  }
+
+  size_t count = 0;
+  memset(sources, 0, sizeof(sources));
+  for (size_t i = 0; i < state->run_count; i++) {
+    sources[count++].fd = state->runs[i];
+  }
+  state->run_count = 0;
+  if (with_chunk) {
+    sources[count].fd = -1;
+    sources[count++].chunk = &state->chunk;
+  }
+  return merge_sources(state, sources, count, out);
+}
+
+
+/* ---- options ---- */
+
+/**
+ * Parse F[.C] at *s, advancing past it.
+ * @return 0 on success, -1 if there is no field number.
+ */
+static int parse_position(const char **s, size_t *field, size_t *chr) {
+  char *end;
+  if (!isdigit((unsigned char)**s)) return -1;
+  *field = strtoul(*s, &end, 10);
+  *s = end;
+  if (**s == '.') {
+    (*s)++;
+    if (!isdigit((unsigned char)**s)) return -1;
+    *chr = strtoul(*s, &end, 10);
+    *s = end;
+  }
+  return 0;
+}
+
+
+/**
+ * Parse ordering letters at *s, advancing past them.
+ * @return Whether any were present.
+ */
+static int parse_key_flags(const char **s, sort_key_t *key) {
+  int any = 0;
+  for (;; (*s)++, any = 1) {
+    if (**s == 'n') {
+      key->numeric = 1;
+    } else if (**s == 'r') {
+      key->reverse = 1;
+    } else if (**s == 'b') {
+      key->skip_blanks = 1;
+    } else {
+      return any;
+    }
+  }
+}
+
+
+/**
+ * Parse a KEYDEF: F[.C][bnr][,F[.C][bnr]]. A key without its own
+ * ordering letters takes -n and -r from the command line.
+ * @return 0 on success, -1 if invalid.
+ */
+static int parse_key(const char *def, sort_key_t *key, int numeric,
+                     int reverse) {
+  const char *s = def;
+  *key = (sort_key_t){ .start_char = 1 };
+  if (parse_position(&s, &key->start_field, &key->start_char) != 0 ||
+      key->start_field == 0 || key->start_char == 0) {
+    return -1;
+  }
+  int flagged = parse_key_flags(&s, key);
+  if (*s == ',') {
+    s++;
+    if (parse_position(&s, &key->end_field, &key->end_char) != 0 ||
+        key->end_field == 0) {
+      return -1;
+    }
+    flagged |= parse_key_flags(&s, key);
+  }
+  if (*s != '\0') return -1;
+  if (!flagged) {
+    key->numeric = numeric;
+    key->reverse = reverse;
+  }
+  return 0;
+}
+
+
+/**
+ * Parse a --buffer-size: a number of KiB, or bytes with a b, K, M, G or
+ * T suffix.
+ * @return The size in bytes, or 0 if invalid.
+ */
+static size_t parse_buffer_size(const char *s) {
+  char *end;
+  errno = 0;
+  unsigned long long n = strtoull(s, &end, 10);
+  if (errno != 0 || end == s) return 0;
+
+  unsigned shift;
+  switch (*end) {
+    case 'b': shift = 0; break;
+    case '\0':
+    case 'k':
+    case 'K': shift = 10; break;
+    case 'm':
+    case 'M': shift = 20; break;
+    case 'g':
+    case 'G': shift = 30; break;
+    case 't':
+    case 'T': shift = 40; break;
+    default: return 0;
+  }
+  if (*end != '\0' && end[1] != '\0') return 0;
+  if (n > (SIZE_MAX >> shift)) return SIZE_MAX;
+  return (size_t)(n << shift);
+}
+
+
+/**
+ * Main entry point for the sort command.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return Exit status (0 on success, 1 on error, 130 on interrupt).
+ */
+static int sort_run(int argc, char **argv) {
+  sort_args_t args;
+  build_sort_argtable(&args);
+
+  jbox_setup_sigint_handler();
+
+  int nerrors = arg_parse(argc, argv, args.argtable);
+
+  if (args.help->count > 0) {
+    sort_print_usage(jbox_stdout());
+    cleanup_sort_argtable(&args);
+    return 0;
+  }
+
+  if (nerrors > 0) {
+    arg_print_errors(stderr, args.end, "sort");
+    fprintf(stderr, "Try 'sort --help' for more information.\n");
+    cleanup_sort_argtable(&args);
+    return 1;
+  }
+
+  sort_state_t state = {
+    .order.tab = -1,
+    .order.reverse = args.reverse->count > 0,
+    .unique = args.unique->count > 0,
+    .budget = SORT_BUFFER_DEFAULT,
+    .tmpdir = getenv("TMPDIR"),
+  };
+  if (!state.tmpdir || !*state.tmpdir) state.tmpdir = "/tmp";
+  if (args.tmpdir->count > 0) state.tmpdir = args.tmpdir->sval[0];
+  int numeric = args.numeric->count > 0;
+
+  int status = 0;
+  if (args.separator->count > 0) {
+    const char *sep = args.separator->sval[0];
+    if (strlen(sep) != 1) {
+      fprintf(stderr, "sort: the field separator must be one character\n");
+      status = 1;
+    }
+    state.order.tab = (unsigned char)sep[0];
+  }
+  if (args.buffer_size->count > 0) {
+    state.budget = parse_buffer_size(args.buffer_size->sval[0]);
+    if (state.budget == 0) {
+      fprintf(stderr, "sort: invalid buffer size '%s'\n",
+              args.buffer_size->sval[0]);
+      status = 1;
+    }
+    if (state.budget < SORT_BUFFER_MIN) state.budget = SORT_BUFFER_MIN;
+  }
+
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  state.workers = cores > 0 ? (int)cores : 1;
+  if (args.parallel->count > 0) {
+    if (args.parallel->ival[0] < 1) {
+      fprintf(stderr, "sort: --parallel must be at least 1\n");
+      status = 1;
+    }
+    state.workers = args.parallel->ival[0];
+  }
+  if (state.workers > SORT_MAX_WORKERS) state.workers = SORT_MAX_WORKERS;
+
+  size_t key_count = args.keys->count > 0 ? (size_t)args.keys->count : 1;
+  state.order.keys = calloc(key_count, sizeof(sort_key_t));
+  state.order.key_count = key_count;
+  if (!state.order.keys) {
+    fprintf(stderr, "sort: out of memory\n");
+    cleanup_sort_argtable(&args);
+    return 1;
+  }
+  if (args.keys->count == 0) {
+    state.order.keys[0] = (sort_key_t){
+      .start_field = 1, .start_char = 1,
+      .numeric = numeric, .reverse = state.order.reverse,
+    };
+  }
+  for (int i = 0; i < args.keys->count && status == 0; i++) {
+    if (parse_key(args.keys->sval[i], &state.order.keys[i], numeric,
+                  state.order.reverse) != 0) {
+      fprintf(stderr, "sort: invalid key '%s'\n", args.keys->sval[i]);
+      status = 1;
+    }
+  }
+  state.order.prefixed = !state.order.keys[0].numeric;
+  /* A whole-line byte key already breaks every tie */
+  state.order.last_resort = !state.unique &&
+                            (args.keys->count > 0 || numeric);
+
+  if (status != 0) {
+    fprintf(stderr, "Try 'sort --help' for more information.\n");
+    free(state.order.keys);
+    cleanup_sort_argtable(&args);
+    return status;
+  }
+
+  int rc = 0;
+  int file_count = args.files->count > 0 ? args.files->count : 1;
+  for (int i = 0; i < file_count && rc == 0; i++) {
+    const char *name = args.files->count > 0 ? args.files->filename[i] : "-";
+    int is_stdin = strcmp(name, "-") == 0;
+    int fd = is_stdin ? STDIN_FILENO : open(name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      fprintf(stderr, "sort: cannot read: %s: %s\n", name, strerror(errno));
+      rc = -1;
+      break;
+    }
+    errno = 0;
+    rc = read_input(&state, fd, name);
+    if (!is_stdin) close(fd);
+  }
+
+  if (rc == 0) {
+    if (sort_chunk(&state) != 0) {
+      fprintf(stderr, "sort: out of memory\n");
+      rc = -1;
+    } else if (state.run_count == 0) {
+      if (write_chunk(&state, jbox_stdout()) != 0) {
+        fprintf(stderr, "sort: write failed: %s\n", strerror(errno));
+        rc = -1;
+      }
+    } else {
+      rc = merge_all(&state, jbox_stdout());
+    }
+  }
+  fflush(jbox_stdout());
+
+  for (size_t i = 0; i < state.run_count; i++) {
+    close(state.runs[i]);
+  }
+  free(state.runs);
+  free(state.chunk.text);
+  free(state.chunk.lines);
+  free(state.chunk.scratch);
+  free(state.order.keys);
+  cleanup_sort_argtable(&args);
+
+  if (rc == -2) return 130;   /* 128 + SIGINT(2) */
+  return rc == 0 ? 0 : 1;
+}
+
+
+/**
+ * Command specification for sort command.
+ */
+const jshell_cmd_spec_t cmd_sort_spec = {
+  .name = "sort",
+  .summary = "sort lines of text",
+  .long_help = "Write the lines of each FILE (or standard input) sorted "
+               "by bytes, or by number with -n, on -k keys split by blanks "
+               "or -t. -r reverses, -u drops lines whose keys repeat. "
+               "Large inputs are sorted on all cores; input beyond "
+               "--buffer-size is sorted in runs on disk and merged.",
+  .type = CMD_EXTERNAL,
+  .run = sort_run,
+  .print_usage = sort_print_usage,
+  .describe_args = sort_describe_args
+};
+
+
+/**
+ * Registers the sort command with the shell command registry.
+ */
+void jshell_register_sort_command(void) {
+  jshell_register_command(&cmd_sort_spec);
+}
@@ -0,0 +1,10 @@
+#ifndef CMD_SORT_H
+#define CMD_SORT_H
+
+#include "jshell/jshell_cmd_registry.h"
+
+extern const jshell_cmd_spec_t cmd_sort_spec;
+
+void jshell_register_sort_command(void);
+
+#endif
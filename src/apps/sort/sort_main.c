@@ -0,0 +1,17 @@
+/**
+ * @file sort_main.c
+ * @brief Main entry point for standalone sort command.
+ */
+
+#include "cmd_sort.h"
+
+
+/**
+ * Main entry point for standalone sort binary.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return Exit status from sort_run.
+ */
+int main(int argc, char **argv) {
+  return cmd_sort_spec.run(argc, argv);
+}
@@ -3,17 +3,143 @@
  * @brief Stat command implementation for jshell.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <pwd.h>
 #include <grp.h>
 #include <time.h>
+#include <unistd.h>
 #include <errno.h>
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_ctx.h"
+#include "utils/jbox_json.h"
+
+
+/** Paths stat'ed together before their results are printed */
+#define STAT_BATCH 4096
+
+/** Upper bound on --parallel */
+#define STAT_MAX_WORKERS 64
+
+
+/** Output fields, in the order they are printed */
+enum {
+  STAT_F_TYPE,
+  STAT_F_SIZE,
+  STAT_F_MODE,
+  STAT_F_UID,
+  STAT_F_GID,
+  STAT_F_OWNER,
+  STAT_F_GROUP,
+  STAT_F_NLINK,
+  STAT_F_INODE,
+  STAT_F_DEV,
+  STAT_F_ATIME,
+  STAT_F_MTIME,
+  STAT_F_CTIME,
+  STAT_F_COUNT
+};
+
+/** Name of each field and the statx() mask bits it needs */
+static const struct {
+  const char *name;
+  unsigned int mask;
+} stat_fields[STAT_F_COUNT] = {
+  [STAT_F_TYPE]  = { "type",  STATX_TYPE },
+  [STAT_F_SIZE]  = { "size",  STATX_SIZE },
+  [STAT_F_MODE]  = { "mode",  STATX_MODE },
+  [STAT_F_UID]   = { "uid",   STATX_UID },
+  [STAT_F_GID]   = { "gid",   STATX_GID },
+  [STAT_F_OWNER] = { "owner", STATX_UID },
+  [STAT_F_GROUP] = { "group", STATX_GID },
+  [STAT_F_NLINK] = { "nlink", STATX_NLINK },
+  [STAT_F_INODE] = { "inode", STATX_INO },
+  [STAT_F_DEV]   = { "dev",   0 },          /* Always filled in */
+  [STAT_F_ATIME] = { "atime", STATX_ATIME },
+  [STAT_F_MTIME] = { "mtime", STATX_MTIME },
+  [STAT_F_CTIME] = { "ctime", STATX_CTIME }
+};
+
+/** Output formats */
+enum {
+  STAT_OUT_TEXT,
+  STAT_OUT_JSON,
+  STAT_OUT_STREAM
+};
+
+
+/** One path and the result of stat'ing it */
+typedef struct {
+  char *path;
+  int err;                  /* errno of a failed stat, else 0 */
+  struct stat st;
+} stat_item_t;
+
+/** How results are printed */
+typedef struct {
+  int format;
+  int fields[STAT_F_COUNT]; /* Field indexes to print, in order */
+  int nfields;
+  int custom_fields;        /* --fields was given */
+  unsigned int mask;        /* STATX_* bits the fields need */
+  int total;                /* Results printed so far */
+  int single;               /* --json of one FILE prints a bare object */
+} stat_opts_t;
+
+/** Cached uid or gid to name lookup */
+typedef struct {
+  unsigned int id;
+  char *name;               /* NULL if the id has no name */
+} stat_id_name_t;
+
+typedef struct {
+  stat_id_name_t *items;
+  size_t count;
+  size_t cap;
+} stat_id_cache_t;
+
+static thread_local stat_id_cache_t stat_users;
+static thread_local stat_id_cache_t stat_groups;
+
+/**
+ * Threads for --parallel.
+ *
+ * The main thread posts a batch of paths as a job; the workers and the
+ * main thread then claim paths one at a time from `next` until the batch
+ * is done, so slow stats on a network filesystem overlap.
+ */
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t wake;      /* A job was posted, or stop was set */
+  pthread_cond_t idle;      /* A worker finished the current job */
+  pthread_t threads[STAT_MAX_WORKERS];
+  int nthreads;
+  int stop;
+  unsigned long job;        /* Bumped for each posted batch */
+  int active;               /* Workers yet to finish the current job */
+  stat_item_t *items;
+  size_t count;
+  unsigned int mask;
+  int dir_fd;               /* Relative paths resolve against it */
+  atomic_size_t next;
+} stat_pool_t;
+
+/** One pool per invoking thread; its workers are handed a pointer to it */
+static thread_local stat_pool_t stat_pool = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .wake = PTHREAD_COND_INITIALIZER,
+  .idle = PTHREAD_COND_INITIALIZER
+};
 
 
 /**
@@ -22,9 +148,13 @@
 typedef struct {
   struct arg_lit *help;
   struct arg_lit *json;
+  struct arg_lit *json_stream;
+  struct arg_lit *stdin0;
+  struct arg_str *fields;
+  struct arg_int *parallel;
   struct arg_file *file;
   struct arg_end *end;
-  void *argtable[4];
+  void *argtable[8];
 } stat_args_t;
 
 
@@ -35,13 +165,27 @@ typedef struct {
 static void build_stat_argtable(stat_args_t *args) {
   args->help = arg_lit0("h", "help", "display this help and exit");
   args->json = arg_lit0(NULL, "json", "output in JSON format");
-  args->file = arg_file1(NULL, NULL, "FILE", "file to get metadata for");
+  args->json_stream = arg_lit0(NULL, "json-stream",
+                               "output one JSON object per line (NDJSON)");
+  args->stdin0 = arg_lit0(NULL, "stdin0",
+                          "also read NUL-separated paths from stdin");
+  args->fields = arg_str0(NULL, "fields", "LIST",
+                          "comma-separated fields to report; only these "
+                          "are fetched");
+  args->parallel = arg_int0(NULL, "parallel", "N",
+                            "stat from N threads at once (default 1)");
+  args->file = arg_filen(NULL, NULL, "FILE", 0, 100000,
+                         "files to get metadata for");
   args->end  = arg_end(20);
 
   args->argtable[0] = args->help;
   args->argtable[1] = args->json;
-  args->argtable[2] = args->file;
-  args->argtable[3] = args->end;
+  args->argtable[2] = args->json_stream;
+  args->argtable[3] = args->stdin0;
+  args->argtable[4] = args->fields;
+  args->argtable[5] = args->parallel;
+  args->argtable[6] = args->file;
+  args->argtable[7] = args->end;
 }
 
 
@@ -67,7 +211,45 @@ static void stat_print_usage(FILE *out) {
   fprintf(out, "Display file metadata.\n\n");
   fprintf(out, "Options:\n");
   arg_print_glossary(out, args.argtable, "  %-20s %s\n");
+  fprintf(out, "\nFields: type, size, mode, uid, gid, owner, group, nlink, "
+               "inode, dev, atime, mtime, ctime.\n");
+  cleanup_stat_argtable(&args);
+}
+
+
+/**
+ * Passes the stat argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void stat_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  stat_args_t args;
+  build_stat_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_stat_argtable(&args);
+}
+
+
+/**
+ * Tells the result cache what the output of stat depends on: the named
+ * files; not with --stdin0, which reads the names from stdin.
+ *
+ * @param argc Number of arguments
+ * @param argv Array of argument strings
+ * @return How this run may be cached
+ */
+static jshell_cmd_cache_t stat_cache_scope(int argc, char **argv) {
+  stat_args_t args;
+  build_stat_argtable(&args);
+  int nerrors = arg_parse(argc, argv, args.argtable);
+  jshell_cmd_cache_t scope = CMD_CACHE_NONE;
+  if (nerrors == 0 && args.help->count == 0
+      && args.stdin0->count == 0 && args.file->count > 0) {
+    scope = CMD_CACHE_FILES;
+  }
   cleanup_stat_argtable(&args);
+  return scope;
 }
 
 
@@ -87,40 +269,6 @@ static const char *get_file_type_string(mode_t mode) {
 }
 
 
-/**
- * Escape special characters in a string for JSON output.
- * @param str Input string to escape.
- * @param out Output buffer for escaped string.
- * @param out_size Size of output buffer.
- */
-static void escape_json_string(const char *str, char *out, size_t out_size) {
-  size_t j = 0;
-  for (size_t i = 0; str[i] && j < out_size - 1; i++) {
-    char c = str[i];
-    if (c == '"' || c == '\\') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = c;
-    } else if (c == '\n') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = 'n';
-    } else if (c == '\r') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = 'r';
-    } else if (c == '\t') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = 't';
-    } else {
-      out[j++] = c;
-    }
-  }
-  out[j] = '\0';
-}
-
-
 /**
  * Format file mode as octal string.
  * @param mode File mode from stat structure.
@@ -132,6 +280,440 @@ static void format_mode_octal(mode_t mode, char *buf, size_t buf_size) {
 }
 
 
+/**
+ * Look up a user or group name, asking the system once per id.
+ * @param cache Cache for the kind of id.
+ * @param id User or group id.
+ * @param group Non-zero if id is a gid, zero for a uid.
+ * @return The name, or "unknown" if the id has none.
+ */
+static const char *lookup_id_name(stat_id_cache_t *cache, unsigned int id,
+                                  int group) {
+  for (size_t i = 0; i < cache->count; i++) {
+    if (cache->items[i].id == id) {
+      return cache->items[i].name ? cache->items[i].name : "unknown";
+    }
+  }
+
+  /* The _r variants: another app may be looking up names on its thread */
+  char buf[1024];
+  const char *name = NULL;
+  if (group) {
+    struct group gr, *res;
+    if (getgrgid_r((gid_t)id, &gr, buf, sizeof(buf), &res) == 0 && res) {
+      name = res->gr_name;
+    }
+  } else {
+    struct passwd pw, *res;
+    if (getpwuid_r((uid_t)id, &pw, buf, sizeof(buf), &res) == 0 && res) {
+      name = res->pw_name;
+    }
+  }
+
+  if (cache->count == cache->cap) {
+    size_t cap = cache->cap ? cache->cap * 2 : 8;
+    stat_id_name_t *items = realloc(cache->items, cap * sizeof(*items));
+    if (!items) {
+      return name ? name : "unknown";
+    }
+    cache->items = items;
+    cache->cap = cap;
+  }
+  stat_id_name_t *item = &cache->items[cache->count++];
+  item->id = id;
+  item->name = name ? strdup(name) : NULL;
+  return item->name ? item->name : "unknown";
+}
+
+
+/**
+ * Free a name cache.
+ * @param cache Cache to empty.
+ */
+static void free_id_cache(stat_id_cache_t *cache) {
+  for (size_t i = 0; i < cache->count; i++) {
+    free(cache->items[i].name);
+  }
+  free(cache->items);
+  cache->items = NULL;
+  cache->count = 0;
+  cache->cap = 0;
+}
+
+
+/**
+ * Stat a path without following a final symlink, asking statx() only for
+ * the fields in mask, and fall back to fstatat() where statx() is missing.
+ * @param dir_fd Directory a relative path is resolved against.
+ * @param path Path to stat.
+ * @param mask STATX_* fields wanted.
+ * @param st Set to the fields that were asked for; the rest are zero.
+ * @return 0 on success, -1 on error (errno set).
+ */
+static int stat_path(int dir_fd, const char *path, unsigned int mask,
+                     struct stat *st) {
+  struct statx sx;
+  if (statx(dir_fd, path, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, mask,
+            &sx) != 0) {
+    if (errno != ENOSYS) return -1;
+    return fstatat(dir_fd, path, st, AT_SYMLINK_NOFOLLOW);
+  }
+
+  memset(st, 0, sizeof(*st));
+  st->st_dev = makedev(sx.stx_dev_major, sx.stx_dev_minor);
+  st->st_ino = sx.stx_ino;
+  st->st_mode = sx.stx_mode;
+  st->st_nlink = sx.stx_nlink;
+  st->st_uid = sx.stx_uid;
+  st->st_gid = sx.stx_gid;
+  st->st_rdev = makedev(sx.stx_rdev_major, sx.stx_rdev_minor);
+  st->st_size = sx.stx_size;
+  st->st_blksize = sx.stx_blksize;
+  st->st_blocks = sx.stx_blocks;
+  st->st_atim.tv_sec = sx.stx_atime.tv_sec;
+  st->st_atim.tv_nsec = sx.stx_atime.tv_nsec;
+  st->st_mtim.tv_sec = sx.stx_mtime.tv_sec;
+  st->st_mtim.tv_nsec = sx.stx_mtime.tv_nsec;
+  st->st_ctim.tv_sec = sx.stx_ctime.tv_sec;
+  st->st_ctim.tv_nsec = sx.stx_ctime.tv_nsec;
+  return 0;
+}
+
+
+/**
+ * Stat items of the current batch until none are left unclaimed.
+ * @param pool Pool the batch was posted to.
+ * @param items Batch of paths.
+ * @param count Number of items.
+ * @param mask STATX_* fields wanted.
+ */
+static void stat_claimed_items(stat_pool_t *pool, stat_item_t *items,
+                               size_t count, unsigned int mask) {
+  for (;;) {
+    size_t i = atomic_fetch_add(&pool->next, 1);
+    if (i >= count) return;
+    items[i].err = stat_path(pool->dir_fd, items[i].path, mask,
+                             &items[i].st) == 0 ? 0 : errno;
+  }
+}
+
+
+/**
+ * Worker thread: takes part in every batch posted to the pool.
+ * @param arg The stat_pool_t of the thread that started it.
+ * @return NULL
+ */
+static void *stat_worker(void *arg) {
+  stat_pool_t *pool = arg;
+  unsigned long seen = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->stop && pool->job == seen) {
+      pthread_cond_wait(&pool->wake, &pool->lock);
+    }
+    if (pool->stop) break;
+    seen = pool->job;
+    stat_item_t *items = pool->items;
+    size_t count = pool->count;
+    unsigned int mask = pool->mask;
+    pthread_mutex_unlock(&pool->lock);
+
+    stat_claimed_items(pool, items, count, mask);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->active == 0) {
+      pthread_cond_signal(&pool->idle);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+
+/**
+ * Start the --parallel workers; the calling thread is one of the N.
+ * @param n Total number of stat threads wanted.
+ */
+static void start_stat_pool(int n) {
+  for (int i = 0; i < n - 1 && i < STAT_MAX_WORKERS; i++) {
+    if (pthread_create(&stat_pool.threads[i], NULL, stat_worker,
+                       &stat_pool) != 0) {
+      break;
+    }
+    stat_pool.nthreads++;
+  }
+}
+
+
+/**
+ * Stop and join the --parallel workers.
+ */
+static void stop_stat_pool(void) {
+  pthread_mutex_lock(&stat_pool.lock);
+  stat_pool.stop = 1;
+  pthread_cond_broadcast(&stat_pool.wake);
+  pthread_mutex_unlock(&stat_pool.lock);
+
+  for (int i = 0; i < stat_pool.nthreads; i++) {
+    pthread_join(stat_pool.threads[i], NULL);
+  }
+  stat_pool.nthreads = 0;
+  stat_pool.stop = 0;
+}
+
+
+/**
+ * Stat a batch of paths, on the pool's threads if there are any.
+ * @param items Batch of paths.
+ * @param count Number of items.
+ * @param mask STATX_* fields wanted.
+ */
+static void stat_batch(stat_item_t *items, size_t count, unsigned int mask) {
+  atomic_store(&stat_pool.next, 0);
+  stat_pool.dir_fd = jbox_cwd_fd();   /* Workers have no context */
+  if (stat_pool.nthreads == 0 || count < 2) {
+    stat_claimed_items(&stat_pool, items, count, mask);
+    return;
+  }
+
+  pthread_mutex_lock(&stat_pool.lock);
+  stat_pool.items = items;
+  stat_pool.count = count;
+  stat_pool.mask = mask;
+  stat_pool.active = stat_pool.nthreads;
+  stat_pool.job++;
+  pthread_cond_broadcast(&stat_pool.wake);
+  pthread_mutex_unlock(&stat_pool.lock);
+
+  stat_claimed_items(&stat_pool, items, count, mask);
+
+  pthread_mutex_lock(&stat_pool.lock);
+  while (stat_pool.active > 0) {
+    pthread_cond_wait(&stat_pool.idle, &stat_pool.lock);
+  }
+  pthread_mutex_unlock(&stat_pool.lock);
+}
+
+
+/**
+ * Parse a --fields list.
+ * @param list Comma-separated field names.
+ * @param opts Options to fill with the fields and their statx mask.
+ * @return 0 on success, -1 if a name is unknown (reported on stderr).
+ */
+static int parse_fields(const char *list, stat_opts_t *opts) {
+  opts->nfields = 0;
+  const char *p = list;
+  while (*p) {
+    const char *comma = strchr(p, ',');
+    size_t len = comma ? (size_t)(comma - p) : strlen(p);
+    int found = -1;
+    for (int f = 0; f < STAT_F_COUNT; f++) {
+      if (strlen(stat_fields[f].name) == len &&
+          strncmp(stat_fields[f].name, p, len) == 0) {
+        found = f;
+        break;
+      }
+    }
+    if (found < 0) {
+      fprintf(stderr, "stat: unknown field '%.*s'\n", (int)len, p);
+      return -1;
+    }
+    if (opts->nfields < STAT_F_COUNT) {
+      opts->fields[opts->nfields++] = found;
+    }
+    if (!comma) break;
+    p = comma + 1;
+  }
+  return 0;
+}
+
+
+/**
+ * Print one field's value as JSON.
+ * @param field STAT_F_* index.
+ * @param st Stat result.
+ */
+static void print_json_value(int field, const struct stat *st) {
+  char mode_octal[8];
+
+  switch (field) {
+    case STAT_F_TYPE:
+      jbox_printf("\"%s\"", get_file_type_string(st->st_mode));
+      break;
+    case STAT_F_SIZE:  jbox_printf("%ld", (long)st->st_size); break;
+    case STAT_F_MODE:
+      format_mode_octal(st->st_mode, mode_octal, sizeof(mode_octal));
+      jbox_printf("\"%s\"", mode_octal);
+      break;
+    case STAT_F_UID:   jbox_printf("%d", st->st_uid); break;
+    case STAT_F_GID:   jbox_printf("%d", st->st_gid); break;
+    case STAT_F_OWNER:
+      jbox_json_write_string(jbox_stdout(),
+                             lookup_id_name(&stat_users, st->st_uid, 0));
+      break;
+    case STAT_F_GROUP:
+      jbox_json_write_string(jbox_stdout(),
+                             lookup_id_name(&stat_groups, st->st_gid, 1));
+      break;
+    case STAT_F_NLINK: jbox_printf("%ld", (long)st->st_nlink); break;
+    case STAT_F_INODE: jbox_printf("%ld", (long)st->st_ino); break;
+    case STAT_F_DEV:   jbox_printf("%ld", (long)st->st_dev); break;
+    case STAT_F_ATIME: jbox_printf("%ld", (long)st->st_atime); break;
+    case STAT_F_MTIME: jbox_printf("%ld", (long)st->st_mtime); break;
+    case STAT_F_CTIME: jbox_printf("%ld", (long)st->st_ctime); break;
+  }
+}
+
+
+/**
+ * Print one field's value as plain text.
+ * @param field STAT_F_* index.
+ * @param st Stat result.
+ */
+static void print_text_value(int field, const struct stat *st) {
+  char mode_octal[8];
+
+  switch (field) {
+    case STAT_F_TYPE:
+      fputs(get_file_type_string(st->st_mode), jbox_stdout());
+      break;
+    case STAT_F_MODE:
+      format_mode_octal(st->st_mode, mode_octal, sizeof(mode_octal));
+      fputs(mode_octal, jbox_stdout());
+      break;
+    case STAT_F_OWNER:
+      fputs(lookup_id_name(&stat_users, st->st_uid, 0), jbox_stdout());
+      break;
+    case STAT_F_GROUP:
+      fputs(lookup_id_name(&stat_groups, st->st_gid, 1), jbox_stdout());
+      break;
+    default:
+      print_json_value(field, st);
+      break;
+  }
+}
+
+
+/**
+ * Print a result as a JSON object.
+ * @param item Path and stat result.
+ * @param opts Output options.
+ * @param pretty Non-zero for one member per line, as single-file --json.
+ */
+static void print_json_item(const stat_item_t *item, const stat_opts_t *opts,
+                            int pretty) {
+  const char *open = pretty ? "{\n  " : "{";
+  const char *sep = pretty ? ",\n  " : ", ";
+  const char *close = pretty ? "\n}" : "}";
+
+  fputs(open, jbox_stdout());
+  fputs("\"path\": ", jbox_stdout());
+  jbox_json_write_string(jbox_stdout(), item->path);
+
+  if (item->err) {
+    fputs(sep, jbox_stdout());
+    fputs("\"error\": ", jbox_stdout());
+    jbox_json_write_string(jbox_stdout(), strerror(item->err));
+  } else {
+    for (int i = 0; i < opts->nfields; i++) {
+      int field = opts->fields[i];
+      fputs(sep, jbox_stdout());
+      jbox_printf("\"%s\": ", stat_fields[field].name);
+      print_json_value(field, &item->st);
+    }
+  }
+  fputs(close, jbox_stdout());
+}
+
+
+/**
+ * Print a result in the classic multi-line text format.
+ * @param item Path and stat result.
+ */
+static void print_text_item(const stat_item_t *item) {
+  const struct stat *st = &item->st;
+  char atime_buf[64], mtime_buf[64], ctime_buf[64];
+  char mode_octal[8];
+  struct tm tm;
+
+  format_mode_octal(st->st_mode, mode_octal, sizeof(mode_octal));
+
+  localtime_r(&st->st_atime, &tm);
+  strftime(atime_buf, sizeof(atime_buf), "%Y-%m-%d %H:%M:%S", &tm);
+
+  localtime_r(&st->st_mtime, &tm);
+  strftime(mtime_buf, sizeof(mtime_buf), "%Y-%m-%d %H:%M:%S", &tm);
+
+  localtime_r(&st->st_ctime, &tm);
+  strftime(ctime_buf, sizeof(ctime_buf), "%Y-%m-%d %H:%M:%S", &tm);
+
+  jbox_printf("  File: %s\n", item->path);
+  jbox_printf("  Size: %-15ld Blocks: %-10ld IO Block: %-6ld %s\n",
+              (long)st->st_size, (long)st->st_blocks, (long)st->st_blksize,
+              get_file_type_string(st->st_mode));
+  jbox_printf("Device: %-15lxh Inode: %-10ld Links: %ld\n",
+              (unsigned long)st->st_dev, (long)st->st_ino, (long)st->st_nlink);
+  jbox_printf("Access: (%s/%04o)  Uid: (%5d/%8s)   Gid: (%5d/%8s)\n",
+              mode_octal, st->st_mode & 07777,
+              st->st_uid, lookup_id_name(&stat_users, st->st_uid, 0),
+              st->st_gid, lookup_id_name(&stat_groups, st->st_gid, 1));
+  jbox_printf("Access: %s\n", atime_buf);
+  jbox_printf("Modify: %s\n", mtime_buf);
+  jbox_printf("Change: %s\n", ctime_buf);
+}
+
+
+/**
+ * Stat and print a batch of paths, freeing them.
+ * @param items Batch of paths.
+ * @param count Number of items.
+ * @param opts Output options.
+ * @return Number of paths that could not be stat'ed.
+ */
+static int run_batch(stat_item_t *items, size_t count, stat_opts_t *opts) {
+  int failed = 0;
+
+  stat_batch(items, count, opts->mask);
+
+  for (size_t i = 0; i < count; i++) {
+    stat_item_t *item = &items[i];
+    if (item->err) failed++;
+
+    if (opts->format == STAT_OUT_STREAM) {
+      print_json_item(item, opts, 0);
+      fputc('\n', jbox_stdout());
+    } else if (opts->format == STAT_OUT_JSON) {
+      if (!opts->single) {
+        fputs(opts->total > 0 ? ",\n  " : "  ", jbox_stdout());
+      }
+      print_json_item(item, opts, opts->single);
+      if (opts->single) fputc('\n', jbox_stdout());
+    } else if (item->err) {
+      fprintf(stderr, "stat: cannot stat '%s': %s\n", item->path,
+              strerror(item->err));
+    } else if (opts->custom_fields) {
+      fputs(item->path, jbox_stdout());
+      for (int f = 0; f < opts->nfields; f++) {
+        fputc('\t', jbox_stdout());
+        print_text_value(opts->fields[f], &item->st);
+      }
+      fputc('\n', jbox_stdout());
+    } else {
+      print_text_item(item);
+    }
+    opts->total++;
+    free(item->path);
+  }
+
+  if (opts->format == STAT_OUT_STREAM) {
+    fflush(jbox_stdout());
+  }
+  return failed;
+}
+
+
 /**
  * Execute the stat command.
  * @param argc Argument count.
@@ -145,7 +727,7 @@ static int stat_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    stat_print_usage(stdout);
+    stat_print_usage(jbox_stdout());
     cleanup_stat_argtable(&args);
     return 0;
   }
@@ -157,78 +739,117 @@ static int stat_run(int argc, char **argv) {
     return 1;
   }
 
-  const char *path = args.file->filename[0];
-  int show_json = args.json->count > 0;
+  int from_stdin = args.stdin0->count > 0;
+  if (args.file->count == 0 && !from_stdin) {
+    fprintf(stderr, "stat: missing operand\n");
+    fprintf(stderr, "Try 'stat --help' for more information.\n");
+    cleanup_stat_argtable(&args);
+    return 1;
+  }
 
-  struct stat st;
-  if (lstat(path, &st) == -1) {
-    if (show_json) {
-      char escaped_path[512];
-      escape_json_string(path, escaped_path, sizeof(escaped_path));
-      printf("{\"path\": \"%s\", \"error\": \"%s\"}\n",
-             escaped_path, strerror(errno));
-    } else {
-      fprintf(stderr, "stat: cannot stat '%s': %s\n", path, strerror(errno));
+  stat_opts_t opts = { 0 };
+  if (args.json_stream->count > 0) {
+    opts.format = STAT_OUT_STREAM;
+  } else if (args.json->count > 0) {
+    opts.format = STAT_OUT_JSON;
+    opts.single = args.file->count == 1 && !from_stdin;
+  }
+
+  if (args.fields->count > 0) {
+    if (parse_fields(args.fields->sval[0], &opts) != 0) {
+      cleanup_stat_argtable(&args);
+      return 1;
+    }
+    opts.custom_fields = 1;
+    for (int i = 0; i < opts.nfields; i++) {
+      opts.mask |= stat_fields[opts.fields[i]].mask;
+    }
+  } else {
+    for (int f = 0; f < STAT_F_COUNT; f++) {
+      opts.fields[opts.nfields++] = f;
+    }
+    opts.mask = STATX_BASIC_STATS;
+  }
+
+  int parallel = 1;
+  if (args.parallel->count > 0) {
+    parallel = args.parallel->ival[0];
+    if (parallel < 1 || parallel > STAT_MAX_WORKERS + 1) {
+      fprintf(stderr, "stat: --parallel must be between 1 and %d\n",
+              STAT_MAX_WORKERS + 1);
+      cleanup_stat_argtable(&args);
+      return 1;
     }
+  }
+
+  stat_item_t *items = malloc(STAT_BATCH * sizeof(*items));
+  if (!items) {
+    fprintf(stderr, "stat: out of memory\n");
     cleanup_stat_argtable(&args);
     return 1;
   }
 
-  struct passwd *pw = getpwuid(st.st_uid);
-  struct group *gr = getgrgid(st.st_gid);
-  char mode_octal[8];
-  format_mode_octal(st.st_mode, mode_octal, sizeof(mode_octal));
-
-  if (show_json) {
-    char escaped_path[512];
-    escape_json_string(path, escaped_path, sizeof(escaped_path));
-
-    printf("{\n");
-    printf("  \"path\": \"%s\",\n", escaped_path);
-    printf("  \"type\": \"%s\",\n", get_file_type_string(st.st_mode));
-    printf("  \"size\": %ld,\n", (long)st.st_size);
-    printf("  \"mode\": \"%s\",\n", mode_octal);
-    printf("  \"uid\": %d,\n", st.st_uid);
-    printf("  \"gid\": %d,\n", st.st_gid);
-    printf("  \"owner\": \"%s\",\n", pw ? pw->pw_name : "unknown");
-    printf("  \"group\": \"%s\",\n", gr ? gr->gr_name : "unknown");
-    printf("  \"nlink\": %ld,\n", (long)st.st_nlink);
-    printf("  \"inode\": %ld,\n", (long)st.st_ino);
-    printf("  \"dev\": %ld,\n", (long)st.st_dev);
-    printf("  \"atime\": %ld,\n", (long)st.st_atime);
-    printf("  \"mtime\": %ld,\n", (long)st.st_mtime);
-    printf("  \"ctime\": %ld\n", (long)st.st_ctime);
-    printf("}\n");
-  } else {
-    char atime_buf[64], mtime_buf[64], ctime_buf[64];
-    struct tm *tm;
+  tzset();
+  start_stat_pool(parallel);
 
-    tm = localtime(&st.st_atime);
-    strftime(atime_buf, sizeof(atime_buf), "%Y-%m-%d %H:%M:%S", tm);
+  if (opts.format == STAT_OUT_JSON && !opts.single) {
+    jbox_printf("[\n");
+  }
 
-    tm = localtime(&st.st_mtime);
-    strftime(mtime_buf, sizeof(mtime_buf), "%Y-%m-%d %H:%M:%S", tm);
+  int failed = 0;
+  size_t count = 0;
+  int oom = 0;
 
-    tm = localtime(&st.st_ctime);
-    strftime(ctime_buf, sizeof(ctime_buf), "%Y-%m-%d %H:%M:%S", tm);
+  for (int i = 0; i < args.file->count && !oom; i++) {
+    items[count].path = strdup(args.file->filename[i]);
+    if (!items[count].path) {
+      oom = 1;
+      break;
+    }
+    if (++count == STAT_BATCH) {
+      failed += run_batch(items, count, &opts);
+      count = 0;
+    }
+  }
 
-    printf("  File: %s\n", path);
-    printf("  Size: %-15ld Blocks: %-10ld IO Block: %-6ld %s\n",
-           (long)st.st_size, (long)st.st_blocks, (long)st.st_blksize,
-           get_file_type_string(st.st_mode));
-    printf("Device: %-15lxh Inode: %-10ld Links: %ld\n",
-           (unsigned long)st.st_dev, (long)st.st_ino, (long)st.st_nlink);
-    printf("Access: (%s/%04o)  Uid: (%5d/%8s)   Gid: (%5d/%8s)\n",
-           mode_octal, st.st_mode & 07777,
-           st.st_uid, pw ? pw->pw_name : "unknown",
-           st.st_gid, gr ? gr->gr_name : "unknown");
-    printf("Access: %s\n", atime_buf);
-    printf("Modify: %s\n", mtime_buf);
-    printf("Change: %s\n", ctime_buf);
+  if (from_stdin && !oom) {
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getdelim(&line, &cap, '\0', jbox_stdin())) > 0) {
+      if (line[len - 1] == '\0') len--;
+      if (len == 0) continue;
+      items[count].path = strndup(line, (size_t)len);
+      if (!items[count].path) {
+        oom = 1;
+        break;
+      }
+      if (++count == STAT_BATCH) {
+        failed += run_batch(items, count, &opts);
+        count = 0;
+      }
+    }
+    free(line);
   }
 
+  if (count > 0) {
+    failed += run_batch(items, count, &opts);
+  }
+
+  if (opts.format == STAT_OUT_JSON && !opts.single) {
+    jbox_printf(opts.total > 0 ? "\n]\n" : "]\n");
+  }
+  if (oom) {
+    fprintf(stderr, "stat: out of memory\n");
+  }
+
+  fflush(jbox_stdout());
+  stop_stat_pool();
+  free(items);
+  free_id_cache(&stat_users);
+  free_id_cache(&stat_groups);
   cleanup_stat_argtable(&args);
-  return 0;
+  return failed > 0 || oom ? 1 : 0;
 }
 
 
@@ -239,10 +860,15 @@ const jshell_cmd_spec_t cmd_stat_spec = {
   .name = "stat",
   .summary = "display file metadata",
   .long_help = "Display detailed information about a file including type, "
-               "size, permissions, ownership, and timestamps.",
+               "size, permissions, ownership, and timestamps. Many paths "
+               "can be given, or read NUL-separated from stdin with "
+               "--stdin0; --fields limits what is fetched and --parallel "
+               "overlaps the calls.",
   .type = CMD_EXTERNAL,
   .run = stat_run,
-  .print_usage = stat_print_usage
+  .print_usage = stat_print_usage,
+  .describe_args = stat_describe_args,
+  .cache_scope = stat_cache_scope
 };
 
 
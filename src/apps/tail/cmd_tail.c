@@ -3,16 +3,32 @@
  * @brief Tail command implementation for jshell.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_ctx.h"
 #include "utils/jbox_signals.h"
+#include "utils/jbox_json.h"
+#include "utils/jbox_linereader.h"
 
 #define DEFAULT_LINES 10
+#define TAIL_BLOCK_SIZE (64 * 1024)
+#define TAIL_POLL_MS 1000
+
+#define TAIL_FOLLOW_NONE 0
+#define TAIL_FOLLOW_DESCRIPTOR 1  /* -f: keep reading the open file */
+#define TAIL_FOLLOW_NAME 2        /* -F: reopen the path if replaced */
 
 
 /**
@@ -21,10 +37,12 @@
 typedef struct {
   struct arg_lit *help;
   struct arg_int *num_lines;
+  struct arg_lit *follow;
+  struct arg_lit *follow_name;
   struct arg_lit *json;
   struct arg_file *file;
   struct arg_end *end;
-  void *argtable[5];
+  void *argtable[7];
 } tail_args_t;
 
 
@@ -36,15 +54,22 @@ static void build_tail_argtable(tail_args_t *args) {
   args->help      = arg_lit0("h", "help", "display this help and exit");
   args->num_lines = arg_int0("n", NULL, "N",
                              "output the last N lines (default 10)");
-  args->json      = arg_lit0(NULL, "json", "output in JSON format");
+  args->follow    = arg_lit0("f", "follow",
+                             "output appended data as the file grows");
+  args->follow_name = arg_lit0("F", NULL,
+                               "like -f, but reopen FILE if it is replaced");
+  args->json      = arg_lit0(NULL, "json",
+                             "output in JSON format (NDJSON when following)");
   args->file      = arg_file1(NULL, NULL, "FILE", "file to read");
   args->end       = arg_end(20);
 
   args->argtable[0] = args->help;
   args->argtable[1] = args->num_lines;
-  args->argtable[2] = args->json;
-  args->argtable[3] = args->file;
-  args->argtable[4] = args->end;
+  args->argtable[2] = args->follow;
+  args->argtable[3] = args->follow_name;
+  args->argtable[4] = args->json;
+  args->argtable[5] = args->file;
+  args->argtable[6] = args->end;
 }
 
 
@@ -75,193 +100,651 @@ static void tail_print_usage(FILE *out) {
 
 
 /**
- * Escape special characters in a string for JSON output.
- * @param str Input string to escape.
- * @param out Output buffer for escaped string.
- * @param out_size Size of output buffer.
+ * Passes the tail argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void tail_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  tail_args_t args;
+  build_tail_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_tail_argtable(&args);
+}
+
+
+/**
+ * Where the requested lines go: text as-is, or JSON array items.
+ */
+typedef struct {
+  int show_json;
+  int line_open;  /* A line has been started but not yet ended */
+  int emitted;    /* Number of lines started so far */
+} tail_out_t;
+
+
+/**
+ * Write part of the tail. Lines may arrive split across calls.
+ * @param out Output state.
+ * @param data Bytes to write, '\n' ending each line.
+ * @param len Number of bytes in data.
  */
-static void escape_json_string(const char *str, char *out, size_t out_size) {
-  size_t j = 0;
-  for (size_t i = 0; str[i] && j < out_size - 1; i++) {
-    char c = str[i];
-    if (c == '"' || c == '\\') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = c;
-    } else if (c == '\n') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = 'n';
-    } else if (c == '\r') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = 'r';
-    } else if (c == '\t') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = 't';
-    } else {
-      out[j++] = c;
+static void tail_out_write(tail_out_t *out, const char *data, size_t len) {
+  if (len == 0) {
+    return;
+  }
+
+  if (!out->show_json) {
+    fwrite(data, 1, len, jbox_stdout());
+    out->line_open = data[len - 1] != '\n';
+    return;
+  }
+
+  while (len > 0) {
+    if (!out->line_open) {
+      fputs(out->emitted++ > 0 ? ", \"" : "\"", jbox_stdout());
+      out->line_open = 1;
+    }
+    const char *nl = memchr(data, '\n', len);
+    size_t n = nl ? (size_t)(nl - data) : len;
+    jbox_json_write_escaped(jbox_stdout(), data, n);
+    if (!nl) {
+      break;
     }
+    fputc('"', jbox_stdout());
+    out->line_open = 0;
+    data += n + 1;
+    len -= n + 1;
   }
-  out[j] = '\0';
 }
 
 
 /**
- * Read all lines from file into an array.
- * @param fp File pointer to read from.
- * @param out_count Pointer to store the number of lines read.
- * @return Array of strings (lines) or NULL on error/interrupt.
+ * End the last line if the input did not.
+ * @param out Output state.
  */
-static char **read_all_lines(FILE *fp, int *out_count) {
-  char **lines = NULL;
-  int capacity = 0;
-  int count = 0;
+static void tail_out_finish(tail_out_t *out) {
+  if (out->line_open) {
+    fputc(out->show_json ? '"' : '\n', jbox_stdout());
+    out->line_open = 0;
+  }
+}
+
 
-  char *line = NULL;
-  size_t len = 0;
-  ssize_t nread;
+/** Block buffer for reading regular files, allocated per invocation. */
+static thread_local char *tail_buffer;
 
-  while ((nread = getline(&line, &len, fp)) != -1) {
-    /* Check for interrupt */
+
+/**
+ * Read exactly len bytes at an offset.
+ * @return 0 on success, -1 on error or early EOF (errno set).
+ */
+static int pread_full(int fd, char *buf, size_t len, off_t offset) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = pread(fd, buf + done, len - done, offset + (off_t)done);
+    if (n < 0) {
+      if (errno == EINTR && !jbox_is_interrupted()) {
+        continue;
+      }
+      return -1;
+    }
+    if (n == 0) {
+      errno = EIO;  /* File shrank under us */
+      return -1;
+    }
+    done += (size_t)n;
+  }
+  return 0;
+}
+
+
+/**
+ * Find where the last N lines of a regular file begin.
+ *
+ * Scans backward from EOF a block at a time, so only the tail is read.
+ *
+ * @param fd File descriptor of a regular file.
+ * @param size Size of the file.
+ * @param num_lines Number of lines wanted.
+ * @param start Set to the offset of the first wanted byte.
+ * @return 0 on success, -1 on read error, -2 on interrupt.
+ */
+static int find_tail_start(int fd, off_t size, int num_lines,
+                           off_t *start) {
+  char *block = tail_buffer;
+  size_t wanted = (size_t)num_lines;
+  off_t pos = size;
+
+  if (num_lines == 0) {
+    *start = size;
+    return 0;
+  }
+
+  while (pos > 0) {
     if (jbox_is_interrupted()) {
-      free(line);
-      for (int i = 0; i < count; i++) {
-        free(lines[i]);
+      return -2;
+    }
+    size_t n = pos > TAIL_BLOCK_SIZE ? TAIL_BLOCK_SIZE : (size_t)pos;
+    pos -= (off_t)n;
+    if (pread_full(fd, block, n, pos) != 0) {
+      return -1;
+    }
+
+    /* A newline as the file's last byte ends the last line rather than
+     * starting another one, so it is not counted. */
+    size_t end = pos + (off_t)n == size ? n - 1 : n;
+    size_t found = jbox_linereader_back(block, end, &wanted);
+    if (found != (size_t)-1) {
+      *start = pos + (off_t)found;
+      return 0;
+    }
+  }
+
+  *start = 0;
+  return 0;
+}
+
+
+/**
+ * Write the last N lines of a regular file without reading the rest.
+ * @return 0 on success, -1 on read error, -2 on interrupt.
+ */
+static int tail_seekable(int fd, off_t size, int num_lines,
+                         tail_out_t *out) {
+  off_t pos;
+
+  int rc = find_tail_start(fd, size, num_lines, &pos);
+  if (rc != 0) {
+    return rc;
+  }
+
+  while (pos < size) {
+    if (jbox_is_interrupted()) {
+      return -2;
+    }
+    size_t n = size - pos > TAIL_BLOCK_SIZE ? TAIL_BLOCK_SIZE
+                                            : (size_t)(size - pos);
+    if (pread_full(fd, tail_buffer, n, pos) != 0) {
+      return -1;
+    }
+    tail_out_write(out, tail_buffer, n);
+    pos += (off_t)n;
+  }
+  return 0;
+}
+
+
+/**
+ * One slot of the ring used for pipes; getline() reuses its buffer.
+ */
+typedef struct {
+  char *text;
+  size_t cap;
+  size_t len;
+} tail_line_t;
+
+
+/**
+ * Write the last N lines of a stream that cannot seek, such as a pipe.
+ *
+ * Only the last N lines are kept, in a ring whose slots are reused, so
+ * memory is bounded by the output rather than the input.
+ *
+ * @return 0 on success, -1 on read error, -2 on interrupt,
+ *         -3 on allocation failure.
+ */
+static int tail_stream(FILE *fp, int num_lines, tail_out_t *out) {
+  tail_line_t *ring = NULL;
+  size_t slots = 0;   /* Allocated slots, at most num_lines */
+  size_t total = 0;   /* Lines read so far */
+  int rc = 0;
+
+  if (num_lines == 0) {
+    return 0;
+  }
+
+  for (;;) {
+    if (jbox_is_interrupted()) {
+      rc = -2;
+      break;
+    }
+
+    size_t idx = total % (size_t)num_lines;
+    if (total < (size_t)num_lines && total == slots) {
+      size_t grow = slots == 0 ? 16 : slots * 2;
+      if (grow > (size_t)num_lines) {
+        grow = (size_t)num_lines;
       }
-      free(lines);
-      *out_count = -1;  /* Signal interruption */
-      return NULL;
+      tail_line_t *bigger = realloc(ring, grow * sizeof(*ring));
+      if (!bigger) {
+        rc = -3;
+        break;
+      }
+      memset(bigger + slots, 0, (grow - slots) * sizeof(*ring));
+      ring = bigger;
+      slots = grow;
     }
 
-    // Remove trailing newline
-    if (nread > 0 && line[nread - 1] == '\n') {
-      line[nread - 1] = '\0';
+    ssize_t nread = getline(&ring[idx].text, &ring[idx].cap, fp);
+    if (nread == -1) {
+      if (ferror(fp)) {
+        rc = -1;
+      }
+      break;
     }
+    ring[idx].len = (size_t)nread;
+    total++;
+  }
+
+  if (rc == 0) {
+    size_t kept = total < (size_t)num_lines ? total : (size_t)num_lines;
+    size_t first = total - kept;
+    for (size_t i = 0; i < kept; i++) {
+      tail_line_t *line = &ring[(first + i) % (size_t)num_lines];
+      tail_out_write(out, line->text, line->len);
+      tail_out_finish(out);
+    }
+  }
+
+  for (size_t i = 0; i < slots; i++) {
+    free(ring[i].text);
+  }
+  free(ring);
+  return rc;
+}
+
+
+/**
+ * Report an error for a file in the selected output format.
+ * @param path Path to the file.
+ * @param error Error message.
+ * @param show_json Whether to output in JSON format.
+ */
+static void tail_report_error(const char *path, const char *error,
+                              int show_json) {
+  if (show_json) {
+    jbox_printf("{\"path\": ");
+    jbox_json_write_string(jbox_stdout(), path);
+    jbox_printf(", \"error\": ");
+    jbox_json_write_string(jbox_stdout(), error);
+    jbox_printf("}\n");
+  } else {
+    fprintf(stderr, "tail: %s: %s\n", path, error);
+  }
+}
+
+
+/**
+ * State for following a file as it grows.
+ */
+typedef struct {
+  const char *path;
+  int fd;
+  dev_t dev;
+  ino_t ino;
+  off_t offset;      /* Next byte to read */
+  int by_name;       /* -F: reopen path when it is replaced */
+  int show_json;
+  int inotify_fd;    /* -1 when polling */
+  int watch;
+  char *partial;     /* JSON mode: start of a line not yet ended */
+  size_t partial_len;
+  size_t partial_cap;
+} tail_follow_t;
+
+
+/**
+ * Write one NDJSON record: any held partial line followed by data.
+ */
+static void follow_emit_line(tail_follow_t *f, const char *data,
+                             size_t len) {
+  jbox_printf("{\"path\": ");
+  jbox_json_write_string(jbox_stdout(), f->path);
+  jbox_printf(", \"line\": \"");
+  jbox_json_write_escaped(jbox_stdout(), f->partial, f->partial_len);
+  jbox_json_write_escaped(jbox_stdout(), data, len);
+  jbox_printf("\"}\n");
+  f->partial_len = 0;
+}
+
 
-    if (count >= capacity) {
-      capacity = capacity == 0 ? 16 : capacity * 2;
-      char **new_lines = realloc(lines, capacity * sizeof(char *));
-      if (!new_lines) {
-        free(line);
-        for (int i = 0; i < count; i++) {
-          free(lines[i]);
-        }
-        free(lines);
-        *out_count = 0;
-        return NULL;
+/**
+ * Write newly appended bytes.
+ *
+ * Text is copied as-is. In JSON mode each completed line becomes a
+ * record, and an unfinished line is held until its newline arrives.
+ *
+ * @return 0 on success, -3 on allocation failure.
+ */
+static int follow_write(tail_follow_t *f, const char *data, size_t len) {
+  if (!f->show_json) {
+    fwrite(data, 1, len, jbox_stdout());
+    return 0;
+  }
+
+  const char *nl;
+  while ((nl = memchr(data, '\n', len)) != NULL) {
+    size_t n = (size_t)(nl - data);
+    follow_emit_line(f, data, n);
+    data += n + 1;
+    len -= n + 1;
+  }
+
+  if (len > 0) {
+    if (f->partial_len + len > f->partial_cap) {
+      size_t cap = f->partial_cap ? f->partial_cap : 256;
+      while (cap < f->partial_len + len) {
+        cap *= 2;
+      }
+      char *bigger = realloc(f->partial, cap);
+      if (!bigger) {
+        return -3;
       }
-      lines = new_lines;
+      f->partial = bigger;
+      f->partial_cap = cap;
     }
+    memcpy(f->partial + f->partial_len, data, len);
+    f->partial_len += len;
+  }
+  return 0;
+}
 
-    lines[count] = strdup(line);
-    if (!lines[count]) {
-      free(line);
-      for (int i = 0; i < count; i++) {
-        free(lines[i]);
+
+/**
+ * Report a change to the followed file other than appended data.
+ * @param f Follow state.
+ * @param event Short name of the event, e.g. "truncated".
+ * @param message Message for text mode.
+ */
+static void follow_notice(tail_follow_t *f, const char *event,
+                          const char *message) {
+  if (f->show_json) {
+    jbox_printf("{\"path\": ");
+    jbox_json_write_string(jbox_stdout(), f->path);
+    jbox_printf(", \"event\": \"%s\"}\n", event);
+    fflush(jbox_stdout());
+  } else {
+    fflush(jbox_stdout());
+    fprintf(stderr, "tail: %s: %s\n", f->path, message);
+  }
+}
+
+
+/**
+ * Read everything appended since the last call.
+ * @return 0 on success, -1 on read error, -2 on interrupt, -3 on
+ *         allocation failure.
+ */
+static int follow_drain(tail_follow_t *f) {
+  struct stat st;
+  if (fstat(f->fd, &st) != 0) {
+    return -1;
+  }
+
+  if (st.st_size < f->offset) {
+    follow_notice(f, "truncated", "file truncated");
+    f->offset = 0;
+    f->partial_len = 0;
+  }
+
+  while (f->offset < st.st_size) {
+    if (jbox_is_interrupted()) {
+      return -2;
+    }
+    size_t want = st.st_size - f->offset > TAIL_BLOCK_SIZE
+                    ? TAIL_BLOCK_SIZE : (size_t)(st.st_size - f->offset);
+    ssize_t n = pread(f->fd, tail_buffer, want, f->offset);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
       }
-      free(lines);
-      *out_count = 0;
-      return NULL;
+      return -1;
+    }
+    if (n == 0) {
+      break;  /* Truncated since fstat; noticed next time */
+    }
+    int rc = follow_write(f, tail_buffer, (size_t)n);
+    if (rc != 0) {
+      return rc;
     }
-    count++;
+    f->offset += n;
   }
 
-  free(line);
-  *out_count = count;
-  return lines;
+  fflush(jbox_stdout());
+  return 0;
 }
 
 
 /**
- * Free an array of lines.
- * @param lines Array of strings to free.
- * @param count Number of strings in the array.
+ * Watch the open file for changes, if inotify is available.
  */
-static void free_lines(char **lines, int count) {
-  for (int i = 0; i < count; i++) {
-    free(lines[i]);
+static void follow_watch(tail_follow_t *f) {
+  if (f->inotify_fd < 0) {
+    return;
+  }
+  if (f->watch >= 0) {
+    inotify_rm_watch(f->inotify_fd, f->watch);
   }
-  free(lines);
+  f->watch = inotify_add_watch(f->inotify_fd, f->path,
+                               IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF |
+                               IN_MOVE_SELF);
+}
+
+
+/**
+ * For -F, switch to a new file if path now names a different one.
+ *
+ * The old file has been drained first, so lines written to it before
+ * the rotation are not lost. While path does not exist the old file is
+ * kept.
+ *
+ * @return 0 on success, -1 on error opening the new file.
+ */
+static int follow_check_rotation(tail_follow_t *f) {
+  struct stat st;
+  if (stat(f->path, &st) != 0 ||
+      (st.st_dev == f->dev && st.st_ino == f->ino)) {
+    return 0;
+  }
+
+  int fd = open(f->path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return errno == ENOENT ? 0 : -1;
+  }
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  close(f->fd);
+  f->fd = fd;
+  f->dev = st.st_dev;
+  f->ino = st.st_ino;
+  f->offset = 0;
+  f->partial_len = 0;
+  follow_watch(f);
+  follow_notice(f, "reopened", "file replaced; following new file");
+  return 0;
+}
+
+
+/**
+ * Sleep until the file may have changed, or until the poll interval
+ * passes.
+ */
+static void follow_wait(tail_follow_t *f) {
+  if (f->inotify_fd < 0) {
+    poll(NULL, 0, TAIL_POLL_MS);
+    return;
+  }
+
+  struct pollfd pfd = { .fd = f->inotify_fd, .events = POLLIN };
+  if (poll(&pfd, 1, TAIL_POLL_MS) > 0) {
+    /* Only the wakeup matters; the events themselves are discarded. */
+    char events[4096];
+    while (read(f->inotify_fd, events, sizeof(events)) > 0) {
+    }
+  }
+}
+
+
+/**
+ * Output data appended to a file until interrupted.
+ *
+ * Waits on inotify, falling back to polling once a second when it is
+ * unavailable; either way appended bytes are read with pread() from the
+ * last offset, so nothing already printed is read again.
+ *
+ * @param path Path the file was opened with.
+ * @param fd Open descriptor of the file; closed on return.
+ * @param offset Offset up to which the file was already printed.
+ * @param by_name Reopen path when it is replaced (-F).
+ * @param show_json Whether to output NDJSON records.
+ * @return Exit status (130 once interrupted, 1 on error).
+ */
+static int tail_follow(const char *path, int fd, off_t offset, int by_name,
+                       int show_json) {
+  tail_follow_t f = {
+    .path = path,
+    .fd = fd,
+    .offset = offset,
+    .by_name = by_name,
+    .show_json = show_json,
+    .inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC),
+    .watch = -1,
+  };
+  struct stat st;
+  int rc = fstat(fd, &st);
+  f.dev = st.st_dev;
+  f.ino = st.st_ino;
+  follow_watch(&f);
+
+  while (rc == 0) {
+    rc = follow_drain(&f);
+    if (rc == 0 && f.by_name) {
+      rc = follow_check_rotation(&f);
+    }
+    if (rc == 0) {
+      if (jbox_is_interrupted()) {
+        rc = -2;
+        break;
+      }
+      follow_wait(&f);
+    }
+  }
+  int saved_errno = errno;
+
+  if (f.partial_len > 0) {
+    follow_emit_line(&f, NULL, 0);
+  }
+  fflush(jbox_stdout());
+
+  if (f.inotify_fd >= 0) {
+    close(f.inotify_fd);
+  }
+  close(f.fd);
+  free(f.partial);
+
+  if (rc == -2) {
+    return 130;  /* 128 + SIGINT(2) */
+  }
+  if (rc == -3) {
+    fprintf(stderr, "tail: %s: memory allocation failed\n", path);
+  } else {
+    fprintf(stderr, "tail: %s: %s\n", path, strerror(saved_errno));
+  }
+  return 1;
 }
 
 
 /**
  * Print the last N lines of a file.
+ *
+ * Regular files are read backward from the end, so the cost follows the
+ * size of the output; anything else, such as a pipe, is read through once.
+ *
  * @param path Path to the file to read.
  * @param num_lines Number of lines to display from the end.
  * @param show_json Whether to output in JSON format.
+ * @param follow TAIL_FOLLOW_NONE, or how to keep printing appended data.
  * @return Exit status (0 on success, non-zero on error).
  */
-static int tail_file(const char *path, int num_lines, int show_json) {
-  FILE *fp = fopen(path, "r");
-  if (!fp) {
-    if (show_json) {
-      char escaped_path[512];
-      escape_json_string(path, escaped_path, sizeof(escaped_path));
-      printf("{\"path\": \"%s\", \"error\": \"%s\"}\n",
-             escaped_path, strerror(errno));
-    } else {
-      fprintf(stderr, "tail: %s: %s\n", path, strerror(errno));
+static int tail_file(const char *path, int num_lines, int show_json,
+                     int follow) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    tail_report_error(path, strerror(errno), show_json);
+    if (fd >= 0) {
+      close(fd);
     }
     return 1;
   }
 
-  int total_lines = 0;
-  char **lines = read_all_lines(fp, &total_lines);
-  fclose(fp);
+  tail_out_t out = { .show_json = show_json };
+  FILE *fp = NULL;
+  off_t end = 0;
+  int rc;
 
-  /* Check for interruption */
-  if (!lines && total_lines == -1) {
-    return 130;  /* 128 + SIGINT(2) */
+  if (show_json) {
+    jbox_printf("{\"path\": ");
+    jbox_json_write_string(jbox_stdout(), path);
+    jbox_printf(", \"lines\": [");
   }
 
-  if (!lines && total_lines != 0) {
-    if (show_json) {
-      char escaped_path[512];
-      escape_json_string(path, escaped_path, sizeof(escaped_path));
-      printf("{\"path\": \"%s\", \"error\": \"memory allocation failed\"}\n",
-             escaped_path);
-    } else {
-      fprintf(stderr, "tail: %s: memory allocation failed\n", path);
-    }
-    return 1;
+  /* Files that report no size, like those in /proc, are read through. */
+  if (S_ISREG(st.st_mode) && st.st_size > 0 &&
+      lseek(fd, 0, SEEK_END) != -1) {
+    rc = tail_seekable(fd, st.st_size, num_lines, &out);
+    end = st.st_size;
+  } else if ((fp = fdopen(fd, "r")) != NULL) {
+    rc = tail_stream(fp, num_lines, &out);
+    end = ftello(fp);
+  } else {
+    rc = -1;
   }
-
-  int start_line = total_lines > num_lines ? total_lines - num_lines : 0;
+  int saved_errno = errno;
+  tail_out_finish(&out);
 
   if (show_json) {
-    char escaped_path[512];
-    escape_json_string(path, escaped_path, sizeof(escaped_path));
-    printf("{\"path\": \"%s\", \"lines\": [", escaped_path);
-
-    for (int i = start_line; i < total_lines; i++) {
-      if (i > start_line) {
-        printf(", ");
-      }
+    jbox_printf("]}\n");
+  }
 
-      size_t line_len = strlen(lines[i]);
-      size_t escaped_size = line_len * 2 + 1;
-      if (escaped_size < 256) escaped_size = 256;
-      char *escaped_line = malloc(escaped_size);
-      if (escaped_line) {
-        escape_json_string(lines[i], escaped_line, escaped_size);
-        printf("\"%s\"", escaped_line);
-        free(escaped_line);
-      } else {
-        printf("\"\"");
-      }
+  /* Only regular files can grow in place; a pipe is done at EOF. */
+  if (rc == 0 && follow != TAIL_FOLLOW_NONE && S_ISREG(st.st_mode)) {
+    fflush(jbox_stdout());
+    int follow_fd = fp ? dup(fileno(fp)) : fd;
+    if (fp) {
+      fclose(fp);
+    }
+    if (follow_fd < 0) {
+      fprintf(stderr, "tail: %s: %s\n", path, strerror(errno));
+      return 1;
     }
+    return tail_follow(path, follow_fd, end, follow == TAIL_FOLLOW_NAME,
+                       show_json);
+  }
 
-    printf("]}\n");
+  if (fp) {
+    fclose(fp);
   } else {
-    for (int i = start_line; i < total_lines; i++) {
-      printf("%s\n", lines[i]);
-    }
+    close(fd);
   }
 
-  free_lines(lines, total_lines);
+  if (rc == -2) {
+    return 130;  /* 128 + SIGINT(2) */
+  }
+  if (rc == -3) {
+    fflush(jbox_stdout());
+    fprintf(stderr, "tail: %s: memory allocation failed\n", path);
+    return 1;
+  }
+  if (rc == -1) {
+    fflush(jbox_stdout());
+    fprintf(stderr, "tail: %s: %s\n", path, strerror(saved_errno));
+    return 1;
+  }
   return 0;
 }
 
@@ -282,7 +765,7 @@ static int tail_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    tail_print_usage(stdout);
+    tail_print_usage(jbox_stdout());
     cleanup_tail_argtable(&args);
     return 0;
   }
@@ -306,9 +789,24 @@ static int tail_run(int argc, char **argv) {
 
   int show_json = args.json->count > 0;
   const char *path = args.file->filename[0];
+  int follow = TAIL_FOLLOW_NONE;
+  if (args.follow_name->count > 0) {
+    follow = TAIL_FOLLOW_NAME;
+  } else if (args.follow->count > 0) {
+    follow = TAIL_FOLLOW_DESCRIPTOR;
+  }
+
+  tail_buffer = jbox_alloc(TAIL_BLOCK_SIZE);
+  if (!tail_buffer) {
+    fprintf(stderr, "tail: %s\n", strerror(ENOMEM));
+    cleanup_tail_argtable(&args);
+    return 1;
+  }
 
-  int result = tail_file(path, num_lines, show_json);
+  int result = tail_file(path, num_lines, show_json, follow);
 
+  jbox_release(tail_buffer);
+  tail_buffer = NULL;
   cleanup_tail_argtable(&args);
   return result;
 }
@@ -321,10 +819,14 @@ const jshell_cmd_spec_t cmd_tail_spec = {
   .name = "tail",
   .summary = "output the last part of files",
   .long_help = "Print the last N lines of FILE to standard output. "
-               "With --json, outputs a JSON object with path and lines array.",
+               "With --json, outputs a JSON object with path and lines array.\n"
+               "With -f, keep printing data appended to FILE; -F also "
+               "reopens FILE when it is rotated. With --json each appended "
+               "line is a {\"path\", \"line\"} object on its own line.",
   .type = CMD_EXTERNAL,
   .run = tail_run,
-  .print_usage = tail_print_usage
+  .print_usage = tail_print_usage,
+  .describe_args = tail_describe_args
 };
 
 
@@ -0,0 +1,672 @@
+/**
+ * @file cmd_tee.c
+ * @brief Implementation of the tee command for copying stdin to files.
+ *
+ * When the input can be spliced, data is duplicated inside the kernel:
+ * tee(2) copies the input pipe's pages into each output pipe (or into a
+ * private relay pipe that is spliced into a file), and the last output
+ * consumes the input with splice(2). Input that is not a pipe is first
+ * spliced into a relay pipe of its own. Terminals, append-mode files and
+ * anything the kernel refuses fall back to reading large chunks once and
+ * writing them to every output.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "argtable3.h"
+#include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_ctx.h"
+#include "utils/jbox_signals.h"
+#include "utils/jbox_json.h"
+
+
+/** Bytes moved per tee/splice/read call */
+#define TEE_CHUNK_SIZE (256 * 1024)
+
+
+/**
+ * Arguments structure for the tee command.
+ */
+typedef struct {
+  struct arg_lit *help;
+  struct arg_lit *append;
+  struct arg_lit *json;
+  struct arg_file *files;
+  struct arg_end *end;
+  void *argtable[5];
+} tee_args_t;
+
+
+/**
+ * One place the input is copied to.
+ */
+typedef struct {
+  const char *path;     /* NULL for stdout */
+  int fd;
+  bool is_pipe;
+  int relay[2];         /* Pipe teed into and spliced to fd, or -1 */
+  int error;            /* errno that stopped copies to it, or 0 */
+} tee_target_t;
+
+
+/**
+ * State of one copy.
+ */
+typedef struct {
+  tee_target_t *targets;
+  int count;
+  int in_fd;            /* Pipe the targets are fed from */
+  int in_relay[2];      /* Pipe stdin is spliced into, or -1 */
+  char *buffer;         /* TEE_CHUNK_SIZE bytes for copies by hand */
+  unsigned long long bytes;
+} tee_state_t;
+
+
+/**
+ * Initializes the argtable3 argument definitions for the tee command.
+ *
+ * @param args Pointer to the tee_args_t structure to initialize.
+ */
+static void build_tee_argtable(tee_args_t *args) {
+  args->help   = arg_lit0("h", "help", "display this help and exit");
+  args->append = arg_lit0("a", "append", "append to the FILEs, do not "
+                          "overwrite");
+  args->json   = arg_lit0(NULL, "json", "copy to the FILEs only and print "
+                          "a JSON report");
+  args->files  = arg_filen(NULL, NULL, "FILE", 0, 100,
+                           "files to copy standard input to");
+  args->end    = arg_end(20);
+
+  args->argtable[0] = args->help;
+  args->argtable[1] = args->append;
+  args->argtable[2] = args->json;
+  args->argtable[3] = args->files;
+  args->argtable[4] = args->end;
+}
+
+
+/**
+ * Frees memory allocated by build_tee_argtable.
+ *
+ * @param args Pointer to the tee_args_t structure to clean up.
+ */
+static void cleanup_tee_argtable(tee_args_t *args) {
+  arg_freetable(args->argtable,
+                sizeof(args->argtable) / sizeof(args->argtable[0]));
+}
+
+
+/**
+ * Prints usage information for the tee command.
+ *
+ * @param out File stream to write usage information to.
+ */
+static void tee_print_usage(FILE *out) {
+  tee_args_t args;
+  build_tee_argtable(&args);
+  fprintf(out, "Usage: tee");
+  arg_print_syntax(out, args.argtable, "\n");
+  fprintf(out, "Copy standard input to each FILE, and also to standard "
+               "output.\n\n");
+  fprintf(out, "Options:\n");
+  arg_print_glossary(out, args.argtable, "  %-20s %s\n");
+  cleanup_tee_argtable(&args);
+}
+
+
+/**
+ * Passes the tee argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void tee_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  tee_args_t args;
+  build_tee_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_tee_argtable(&args);
+}
+
+
+/**
+ * Writes a whole buffer to a descriptor, retrying short writes.
+ *
+ * @param fd  Descriptor to write to.
+ * @param buf Data to write.
+ * @param len Number of bytes to write.
+ * @return 0 on success, -1 on error with errno set.
+ */
+static int write_all(int fd, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR && !jbox_is_interrupted()) {
+        continue;
+      }
+      return -1;
+    }
+    buf += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+
+/**
+ * Reads exactly len bytes unless the input ends first.
+ *
+ * @param fd  Descriptor to read from.
+ * @param buf Buffer of at least len bytes.
+ * @param len Number of bytes wanted.
+ * @return Bytes read, or -1 on error with errno set.
+ */
+static ssize_t read_full(int fd, char *buf, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = read(fd, buf + done, len - done);
+    if (n < 0) {
+      if (errno == EINTR && !jbox_is_interrupted()) {
+        continue;
+      }
+      return -1;
+    }
+    if (n == 0) {
+      break;
+    }
+    done += (size_t)n;
+  }
+  return (ssize_t)done;
+}
+
+
+/**
+ * Closes a pipe made by tee, if it was made.
+ *
+ * @param fds The pipe's descriptors, set to -1.
+ */
+static void close_relay(int fds[2]) {
+  if (fds[0] != -1) {
+    close(fds[0]);
+    close(fds[1]);
+  }
+  fds[0] = fds[1] = -1;
+}
+
+
+/**
+ * Stops copying to a target after a failed write.
+ *
+ * A reader of stdout going away is not reported: the FILEs still get
+ * the whole input, as when tee feeds a `head`.
+ *
+ * @param t   The target.
+ * @param err errno of the failure.
+ */
+static void target_failed(tee_target_t *t, int err) {
+  t->error = err != 0 ? err : EIO;
+  close_relay(t->relay);
+  if (t->path == NULL && err == EPIPE) {
+    return;
+  }
+  fprintf(stderr, "tee: %s: %s\n", t->path ? t->path : "standard output",
+          strerror(t->error));
+}
+
+
+/**
+ * Finds the last target still being copied to.
+ *
+ * @param st Copy state.
+ * @return Its index, or -1 if every target failed.
+ */
+static int last_live_target(const tee_state_t *st) {
+  for (int i = st->count - 1; i >= 0; i--) {
+    if (st->targets[i].error == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+
+/**
+ * Writes a buffer to the live targets from index from on.
+ *
+ * @param st   Copy state.
+ * @param from First target to write to.
+ * @param buf  Data.
+ * @param len  Number of bytes.
+ */
+static void write_to_targets(tee_state_t *st, int from, const char *buf,
+                             size_t len) {
+  for (int i = from; i < st->count; i++) {
+    tee_target_t *t = &st->targets[i];
+    if (t->error == 0 && write_all(t->fd, buf, len) != 0) {
+      target_failed(t, errno);
+    }
+  }
+}
+
+
+/**
+ * Copies stdin to every target through the buffer.
+ *
+ * @param st Copy state.
+ * @return 0 at the end of input, -1 on a read error.
+ */
+static int copy_buffered(tee_state_t *st) {
+  while (!jbox_is_interrupted() && last_live_target(st) >= 0) {
+    ssize_t n = read(jbox_stdin_fd(), st->buffer, TEE_CHUNK_SIZE);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "tee: read error: %s\n", strerror(errno));
+      return -1;
+    }
+    if (n == 0) {
+      break;
+    }
+    st->bytes += (unsigned long long)n;
+    write_to_targets(st, 0, st->buffer, (size_t)n);
+  }
+  return 0;
+}
+
+
+/**
+ * Moves len bytes from a pipe into a target by splice.
+ *
+ * @param t    The target.
+ * @param from Pipe to move from.
+ * @param len Number of bytes, all in the pipe.
+ * @return Bytes moved; fewer than len if the kernel refused (errno
+ *         set), the rest still in the pipe.
+ */
+static size_t splice_out(tee_target_t *t, int from, size_t len) {
+  size_t moved = 0;
+  while (moved < len) {
+    ssize_t n = splice(from, NULL, t->fd, NULL, len - moved, SPLICE_F_MOVE);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      if (n == 0) {
+        errno = EIO;
+      }
+      break;
+    }
+    moved += (size_t)n;
+  }
+  return moved;
+}
+
+
+/**
+ * Copies what is left of a pipe's data to a target by hand.
+ *
+ * @param st   Copy state.
+ * @param t    The target, or NULL to discard the data.
+ * @param from Pipe to read from.
+ * @param len  Number of bytes, all in the pipe.
+ * @return 0 on success, -1 if the pipe could not be read.
+ */
+static int drain_by_hand(tee_state_t *st, tee_target_t *t, int from,
+                         size_t len) {
+  ssize_t n = read_full(from, st->buffer, len);
+  if (n < 0) {
+    return -1;
+  }
+  if (t != NULL && t->error == 0
+      && write_all(t->fd, st->buffer, (size_t)n) != 0) {
+    target_failed(t, errno);
+  }
+  return 0;
+}
+
+
+/**
+ * Copies one chunk of the input pipe to every live target.
+ *
+ * Every target but the last gets a tee(2) of the same leading bytes of
+ * the pipe; the last takes them out of it with splice(2). A target that
+ * tee(2) cannot take in full (its pipe is full of small buffers) has the
+ * chunk read out by hand instead, and so have the targets after it.
+ *
+ * @param st     Copy state.
+ * @param len    Bytes known to be in the input pipe, or 0 for "up to a
+ *               chunk, waiting for some".
+ * @param by_hand Set to true if the kernel refused a splice, so later
+ *                chunks should be copied through the buffer.
+ * @return Bytes copied, 0 at the end of input, -1 on error.
+ */
+static ssize_t tee_chunk(tee_state_t *st, size_t len, bool *by_hand) {
+  int last = last_live_target(st);
+  ssize_t n = len > 0 ? (ssize_t)len : -1;
+
+  for (int i = 0; i < last; i++) {
+    tee_target_t *t = &st->targets[i];
+    if (t->error != 0) {
+      continue;
+    }
+    int dest = t->relay[1] != -1 ? t->relay[1] : t->fd;
+    ssize_t m = tee(st->in_fd, dest, n < 0 ? TEE_CHUNK_SIZE : (size_t)n, 0);
+    if (m < 0) {
+      if (errno == EINTR) {
+        i--;
+        continue;
+      }
+      target_failed(t, errno);
+      continue;
+    }
+    if (n < 0) {
+      n = m;
+      if (n == 0) {
+        return 0;
+      }
+    }
+
+    if (t->relay[0] != -1) {
+      size_t moved = splice_out(t, t->relay[0], (size_t)m);
+      if (moved < (size_t)m) {
+        *by_hand = true;
+        if (drain_by_hand(st, t, t->relay[0], (size_t)m - moved) != 0) {
+          target_failed(t, errno);
+        }
+      }
+    }
+
+    if (m < n) {
+      /* The pipe cannot be teed from an offset: take the chunk out */
+      ssize_t got = read_full(st->in_fd, st->buffer, (size_t)n);
+      if (got < 0) {
+        return -1;
+      }
+      if (t->error == 0 && write_all(t->fd, st->buffer + m,
+                                     (size_t)(got - m)) != 0) {
+        target_failed(t, errno);
+      }
+      write_to_targets(st, i + 1, st->buffer, (size_t)got);
+      return got;
+    }
+  }
+
+  tee_target_t *t = &st->targets[last];
+  size_t want = n < 0 ? TEE_CHUNK_SIZE : (size_t)n;
+  while (n < 0) {
+    /* The last target is the only one: it decides the chunk size */
+    ssize_t m = splice(st->in_fd, NULL, t->fd, NULL, want, SPLICE_F_MOVE);
+    if (m < 0 && errno == EINTR) {
+      continue;
+    }
+    if (m == 0) {
+      return 0;
+    }
+    if (m > 0) {
+      return m;
+    }
+    /* Refused before anything moved: let the caller read by hand */
+    *by_hand = true;
+    return copy_buffered(st) == 0 ? 0 : -1;
+  }
+
+  size_t moved = splice_out(t, st->in_fd, want);
+  if (moved < want) {
+    int err = errno;
+    *by_hand = true;
+    if (err != EINVAL && err != ENOSYS && err != EOPNOTSUPP) {
+      target_failed(t, err);
+    }
+    if (drain_by_hand(st, t, st->in_fd, want - moved) != 0) {
+      return -1;
+    }
+  }
+  return n;
+}
+
+
+/**
+ * Tells whether a descriptor refuses splice output for the copy to be
+ * the same: terminals, which show data as it comes, and files opened
+ * for appending.
+ *
+ * @param fd Descriptor.
+ * @return true if the copy should go through the buffer.
+ */
+static bool needs_buffered_copy(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+  return isatty(fd) || (flags != -1 && (flags & O_APPEND));
+}
+
+
+/**
+ * Makes a pipe for relaying data into a descriptor that is no pipe.
+ *
+ * @param fds Set to the pipe's descriptors.
+ * @return 0 on success, -1 on error.
+ */
+static int open_relay(int fds[2]) {
+  if (pipe2(fds, O_CLOEXEC) != 0) {
+    fds[0] = fds[1] = -1;
+    return -1;
+  }
+  /* Room for a chunk, so a tee into it is not cut short; best effort */
+  (void)fcntl(fds[1], F_SETPIPE_SZ, TEE_CHUNK_SIZE);
+  return 0;
+}
+
+
+/**
+ * Copies stdin to the targets in the kernel where it can.
+ *
+ * @param st Copy state.
+ * @return 0 on success, -1 on a read error.
+ */
+static int copy_spliced(tee_state_t *st) {
+  if (isatty(jbox_stdin_fd())) {
+    return copy_buffered(st);
+  }
+  for (int i = 0; i < st->count; i++) {
+    tee_target_t *t = &st->targets[i];
+    if (needs_buffered_copy(t->fd)) {
+      return copy_buffered(st);
+    }
+    struct stat sb;
+    t->is_pipe = fstat(t->fd, &sb) == 0 && S_ISFIFO(sb.st_mode);
+    if (!t->is_pipe && i < st->count - 1 && open_relay(t->relay) != 0) {
+      return copy_buffered(st);
+    }
+  }
+
+  struct stat in_st;
+  st->in_fd = jbox_stdin_fd();
+  if (fstat(st->in_fd, &in_st) != 0 || !S_ISFIFO(in_st.st_mode)) {
+    if (open_relay(st->in_relay) != 0) {
+      return copy_buffered(st);
+    }
+    st->in_fd = st->in_relay[0];
+  }
+
+  bool by_hand = false;
+  while (!by_hand && !jbox_is_interrupted() && last_live_target(st) >= 0) {
+    size_t len = 0;
+    if (st->in_relay[0] != -1) {
+      ssize_t n = splice(jbox_stdin_fd(), NULL, st->in_relay[1], NULL,
+                         TEE_CHUNK_SIZE, SPLICE_F_MOVE);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n < 0) {
+        /* Nothing was taken from stdin, so the buffer can carry on */
+        return copy_buffered(st);
+      }
+      if (n == 0) {
+        return 0;
+      }
+      len = (size_t)n;
+    }
+
+    ssize_t n = tee_chunk(st, len, &by_hand);
+    if (n < 0) {
+      fprintf(stderr, "tee: read error: %s\n", strerror(errno));
+      return -1;
+    }
+    if (n == 0) {
+      return 0;
+    }
+    st->bytes += (unsigned long long)n;
+  }
+
+  return by_hand ? copy_buffered(st) : 0;
+}
+
+
+/**
+ * Prints the --json report.
+ *
+ * @param st Copy state.
+ */
+static void print_json_report(const tee_state_t *st) {
+  jbox_printf("{\"bytes\": %llu, \"files\": [", st->bytes);
+  for (int i = 0; i < st->count; i++) {
+    const tee_target_t *t = &st->targets[i];
+    jbox_printf(i == 0 ? "{\"path\": " : ", {\"path\": ");
+    jbox_json_write_string(jbox_stdout(), t->path);
+    if (t->error != 0) {
+      jbox_printf(", \"error\": ");
+      jbox_json_write_string(jbox_stdout(), strerror(t->error));
+    }
+    jbox_printf("}");
+  }
+  jbox_printf("]}\n");
+}
+
+
+/**
+ * Main entry point for the tee command.
+ *
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return 0 on success, 1 if a file could not be opened or written.
+ */
+static int tee_run(int argc, char **argv) {
+  tee_args_t args;
+  build_tee_argtable(&args);
+
+  jbox_setup_sigint_handler();
+
+  int nerrors = arg_parse(argc, argv, args.argtable);
+
+  if (args.help->count > 0) {
+    tee_print_usage(jbox_stdout());
+    cleanup_tee_argtable(&args);
+    return 0;
+  }
+
+  if (nerrors > 0) {
+    arg_print_errors(stderr, args.end, "tee");
+    fprintf(stderr, "Try 'tee --help' for more information.\n");
+    cleanup_tee_argtable(&args);
+    return 1;
+  }
+
+  bool show_json = args.json->count > 0;
+  tee_state_t st = {
+    .targets = jbox_alloc((size_t)(args.files->count + 1)
+                          * sizeof(tee_target_t)),
+    .in_relay = { -1, -1 },
+    .buffer = jbox_alloc(TEE_CHUNK_SIZE),
+  };
+  if (st.targets == NULL || st.buffer == NULL) {
+    fprintf(stderr, "tee: %s\n", strerror(ENOMEM));
+    jbox_release(st.targets);
+    jbox_release(st.buffer);
+    cleanup_tee_argtable(&args);
+    return 1;
+  }
+
+  int result = 0;
+  if (!show_json) {
+    fflush(jbox_stdout());
+    st.targets[st.count++] = (tee_target_t){
+      .fd = jbox_stdout_fd(), .relay = { -1, -1 }
+    };
+  }
+  int flags = O_WRONLY | O_CREAT | O_CLOEXEC
+              | (args.append->count > 0 ? O_APPEND : O_TRUNC);
+  for (int i = 0; i < args.files->count; i++) {
+    tee_target_t *t = &st.targets[st.count++];
+    *t = (tee_target_t){ .path = args.files->filename[i],
+                         .relay = { -1, -1 } };
+    t->fd = open(t->path, flags, 0666);
+    if (t->fd < 0) {
+      target_failed(t, errno);
+      result = 1;
+    }
+  }
+
+  if (copy_spliced(&st) != 0) {
+    result = 1;
+  }
+  if (jbox_is_interrupted()) {
+    result = 130;  /* 128 + SIGINT(2) */
+  }
+
+  close_relay(st.in_relay);
+  for (int i = 0; i < st.count; i++) {
+    tee_target_t *t = &st.targets[i];
+    close_relay(t->relay);
+    if (t->path == NULL) {
+      continue;
+    }
+    if (t->fd >= 0 && close(t->fd) != 0 && t->error == 0) {
+      target_failed(t, errno);
+    }
+    if (t->error != 0 && result == 0) {
+      result = 1;
+    }
+  }
+
+  if (show_json) {
+    print_json_report(&st);
+  }
+
+  jbox_release(st.targets);
+  jbox_release(st.buffer);
+  cleanup_tee_argtable(&args);
+  return result;
+}
+
+
+/**
+ * Command specification for the tee command.
+ */
+const jshell_cmd_spec_t cmd_tee_spec = {
+  .name = "tee",
+  .summary = "copy standard input to files and standard output",
+  .long_help = "Copy standard input to each FILE and to standard output. "
+               "Pipes are duplicated with tee(2) and splice(2), so the "
+               "data does not pass through user space. With --json, "
+               "copies to the FILEs only and prints a report.",
+  .type = CMD_EXTERNAL,
+  .run = tee_run,
+  .print_usage = tee_print_usage,
+  .describe_args = tee_describe_args
+};
+
+
+/**
+ * Registers the tee command with the shell command registry.
+ */
+void jshell_register_tee_command(void) {
+  jshell_register_command(&cmd_tee_spec);
+}
@@ -0,0 +1,10 @@
+#ifndef CMD_TEE_H
+#define CMD_TEE_H
+
+#include "jshell/jshell_cmd_registry.h"
+
+extern const jshell_cmd_spec_t cmd_tee_spec;
+
+void jshell_register_tee_command(void);
+
+#endif
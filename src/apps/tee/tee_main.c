@@ -0,0 +1,21 @@
+/**
+ * @file tee_main.c
+ * @brief Standalone binary entry point for the tee command.
+ */
+
+#include <signal.h>
+
+#include "cmd_tee.h"
+
+/**
+ * Main entry point for the standalone tee binary.
+ *
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return Exit status from the tee command.
+ */
+int main(int argc, char **argv) {
+  /* A reader of stdout leaving must not cut the FILEs short, as in jshell */
+  signal(SIGPIPE, SIG_IGN);
+  return cmd_tee_spec.run(argc, argv);
+}
@@ -3,17 +3,20 @@
  * @brief Touch command implementation for jshell.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <sys/stat.h>
-#include <utime.h>
 #include <fcntl.h>
 #include <unistd.h>
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_ctx.h"
+#include "utils/jbox_dircache.h"
 
 
 /**
@@ -22,9 +25,10 @@
 typedef struct {
   struct arg_lit *help;
   struct arg_lit *json;
+  struct arg_lit *stdin0;
   struct arg_file *files;
   struct arg_end *end;
-  void *argtable[4];
+  void *argtable[5];
 } touch_args_t;
 
 
@@ -35,14 +39,17 @@ typedef struct {
 static void build_touch_argtable(touch_args_t *args) {
   args->help  = arg_lit0("h", "help", "display this help and exit");
   args->json  = arg_lit0(NULL, "json", "output in JSON format");
-  args->files = arg_filen(NULL, NULL, "FILE", 1, 100, "files to create or "
+  args->stdin0 = arg_lit0(NULL, "stdin0", "also read NUL-separated files "
+                          "from stdin");
+  args->files = arg_filen(NULL, NULL, "FILE", 0, 100000, "files to create or "
                           "update");
   args->end   = arg_end(20);
 
   args->argtable[0] = args->help;
   args->argtable[1] = args->json;
-  args->argtable[2] = args->files;
-  args->argtable[3] = args->end;
+  args->argtable[2] = args->stdin0;
+  args->argtable[3] = args->files;
+  args->argtable[4] = args->end;
 }
 
 
@@ -74,6 +81,21 @@ static void touch_print_usage(FILE *out) {
 }
 
 
+/**
+ * Passes the touch argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void touch_describe_args(jshell_argtable_visit_fn visit,
+                                void *userdata) {
+  touch_args_t args;
+  build_touch_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_touch_argtable(&args);
+}
+
+
 /**
  * Escape special characters in a string for JSON output.
  * @param str Input string to escape.
@@ -110,25 +132,32 @@ static void escape_json_string(const char *str, char *out, size_t out_size) {
 
 /**
  * Touch a single file (create or update timestamp).
+ *
+ * The file's directory comes from the cache, and the file is created
+ * with openat(O_EXCL) or, if it exists, updated with utimensat(), so a
+ * path under an already seen directory costs two system calls at most.
+ *
+ * @param cache Directory cache shared by all paths.
  * @param path Path to the file to touch.
  * @param show_json Whether to output in JSON format.
  * @param first_entry Pointer to flag tracking if this is the first JSON entry.
  * @return 0 on success, -1 on error.
  */
-static int touch_file(const char *path, int show_json, int *first_entry) {
+static int touch_file(jbox_dircache_t *cache, const char *path, int show_json,
+                      int *first_entry) {
   int result = 0;
-  struct stat st;
+  const char *leaf;
+  int dirfd = jbox_dircache_parent(cache, path, 0, 0755, &leaf);
 
-  if (stat(path, &st) == 0) {
-    if (utime(path, NULL) != 0) {
-      result = -1;
-    }
+  if (dirfd == -1) {
+    result = -1;
   } else {
-    int fd = open(path, O_WRONLY | O_CREAT, 0644);
-    if (fd < 0) {
-      result = -1;
-    } else {
+    int fd = openat(dirfd, leaf, O_WRONLY | O_CREAT | O_EXCL | O_NOCTTY |
+                    O_NONBLOCK | O_CLOEXEC, 0644);
+    if (fd >= 0) {
       close(fd);
+    } else if (errno != EEXIST || utimensat(dirfd, leaf, NULL, 0) != 0) {
+      result = -1;
     }
   }
 
@@ -137,18 +166,18 @@ static int touch_file(const char *path, int show_json, int *first_entry) {
     escape_json_string(path, escaped_path, sizeof(escaped_path));
 
     if (!*first_entry) {
-      printf(",\n");
+      jbox_printf(",\n");
     }
     *first_entry = 0;
 
     if (result == 0) {
-      printf("{\"path\": \"%s\", \"status\": \"ok\"}", escaped_path);
+      jbox_printf("{\"path\": \"%s\", \"status\": \"ok\"}", escaped_path);
     } else {
       char escaped_error[256];
       escape_json_string(strerror(errno), escaped_error,
                          sizeof(escaped_error));
-      printf("{\"path\": \"%s\", \"status\": \"error\", \"message\": \"%s\"}",
-             escaped_path, escaped_error);
+      jbox_printf("{\"path\": \"%s\", \"status\": \"error\", "
+                  "\"message\": \"%s\"}", escaped_path, escaped_error);
     }
   } else {
     if (result != 0) {
@@ -173,7 +202,7 @@ static int touch_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    touch_print_usage(stdout);
+    touch_print_usage(jbox_stdout());
     cleanup_touch_argtable(&args);
     return 0;
   }
@@ -186,23 +215,55 @@ static int touch_run(int argc, char **argv) {
   }
 
   int show_json = args.json->count > 0;
+  int from_stdin = args.stdin0->count > 0;
   int first_entry = 1;
   int result = 0;
 
+  if (args.files->count == 0 && !from_stdin) {
+    fprintf(stderr, "touch: missing file operand\n");
+    fprintf(stderr, "Try 'touch --help' for more information.\n");
+    cleanup_touch_argtable(&args);
+    return 1;
+  }
+
+  jbox_dircache_t *cache = jbox_dircache_new();
+  if (!cache) {
+    fprintf(stderr, "touch: out of memory\n");
+    cleanup_touch_argtable(&args);
+    return 1;
+  }
+
   if (show_json) {
-    printf("[\n");
+    jbox_printf("[\n");
   }
 
   for (int i = 0; i < args.files->count; i++) {
-    if (touch_file(args.files->filename[i], show_json, &first_entry) != 0) {
+    if (touch_file(cache, args.files->filename[i], show_json,
+                   &first_entry) != 0) {
       result = 1;
     }
   }
 
+  if (from_stdin) {
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getdelim(&line, &cap, '\0', jbox_stdin())) > 0) {
+      if (line[len - 1] == '\0') len--;
+      if (len == 0) continue;
+      line[len] = '\0';
+      if (touch_file(cache, line, show_json, &first_entry) != 0) {
+        result = 1;
+      }
+    }
+    free(line);
+  }
+
   if (show_json) {
-    printf("\n]\n");
+    jbox_printf("\n]\n");
   }
 
+  jbox_dircache_free(cache);
   cleanup_touch_argtable(&args);
   return result;
 }
@@ -216,10 +277,12 @@ const jshell_cmd_spec_t cmd_touch_spec = {
   .summary = "change file timestamps",
   .long_help = "Update the access and modification times of each FILE to the "
                "current time. A FILE argument that does not exist is created "
-               "empty.",
+               "empty. With --stdin0, NUL-separated files are also read from "
+               "stdin.",
   .type = CMD_EXTERNAL,
   .run = touch_run,
-  .print_usage = touch_print_usage
+  .print_usage = touch_print_usage,
+  .describe_args = touch_describe_args
 };
 
 
@@ -1,5 +1,12 @@
 /** @file cmd_vi.c
  *  @brief Vi-like text editor implementation
+ *
+ * The text lives in a piece table (see vi_buffer.h): a file is mapped
+ * rather than read, and every edit is an insertion or deletion at a
+ * byte offset, found from the cursor's line and column. Each edit is
+ * also journaled to FILE.swp (see vi_swap.h) for recovery with -r, and
+ * recorded in an undo tree (see vi_undo.h) that keeps deleted text as
+ * the pieces that held it.
  */
 
 #include <stdio.h>
@@ -11,9 +18,32 @@
 #include <sys/ioctl.h>
 #include <signal.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <poll.h>
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_screen.h"
+#include "vi_buffer.h"
+#include "vi_search.h"
+#include "vi_swap.h"
+#include "vi_undo.h"
+
+
+/** Spans of text handed to each writev() when saving */
+#define VI_SAVE_IOV 1024
+
+/** Undo groups kept, as vim's default 'undolevels' */
+#define VI_UNDO_LEVELS 1000
+
+/** Bytes of terminal input read at a time */
+#define VI_INPUT_SIZE 4096
+
+/** Read timeouts a paste may go quiet for before its end is assumed */
+#define VI_PASTE_IDLE 10
 
 
 /** Vi editor modes */
@@ -28,25 +58,20 @@ typedef enum {
 /** Argtable structure for vi command arguments */
 typedef struct {
   struct arg_lit *help;
+  struct arg_lit *recover;
   struct arg_file *file;
   struct arg_end *end;
-  void *argtable[3];
+  void *argtable[4];
 } vi_args_t;
 
 
-/** Single line in the editor buffer */
-typedef struct {
-  char *text;
-  size_t len;
-  size_t capacity;
-} vi_line_t;
-
-
 /** Complete editor state */
 typedef struct {
-  vi_line_t *lines;
+  vi_buffer_t *buf;
+  vi_swap_t *swap;
+  vi_undo_t *undo;
+  unsigned long saved_seq;    /* Undo state of the text on disk */
   size_t line_count;
-  size_t line_capacity;
   size_t cursor_row;
   size_t cursor_col;
   size_t top_line;
@@ -58,8 +83,11 @@ typedef struct {
   char status_msg[256];
   char command_buf[256];
   size_t command_len;
+  vi_pattern_t *search_pat;   /* Last pattern searched for */
+  char search_str[256];
   char yank_buf[4096];
   int yank_is_line;
+  jbox_screen_t *screen;
 } vi_state_t;
 
 
@@ -68,6 +96,11 @@ static volatile sig_atomic_t term_resized = 0;
 static volatile sig_atomic_t term_suspended = 0;
 static volatile sig_atomic_t term_terminated = 0;
 
+/** Terminal input read ahead of the keys taken from it */
+static char input_buf[VI_INPUT_SIZE];
+static size_t input_len = 0;
+static size_t input_pos = 0;
+
 
 /**
  * Builds the argtable3 argument table for vi command.
@@ -75,12 +108,15 @@ static volatile sig_atomic_t term_terminated = 0;
  */
 static void build_vi_argtable(vi_args_t *args) {
   args->help = arg_lit0("h", "help", "display this help and exit");
+  args->recover = arg_lit0("r", "recover",
+                           "replay FILE's unsaved edits from FILE.swp");
   args->file = arg_file0(NULL, NULL, "FILE", "file to edit");
   args->end = arg_end(20);
 
   args->argtable[0] = args->help;
-  args->argtable[1] = args->file;
-  args->argtable[2] = args->end;
+  args->argtable[1] = args->recover;
+  args->argtable[2] = args->file;
+  args->argtable[3] = args->end;
 }
 
 
@@ -126,15 +162,34 @@ static void vi_print_usage(FILE *out) {
   fprintf(out, "  yy            Yank (copy) line\n");
   fprintf(out, "  p             Paste after cursor/line\n");
   fprintf(out, "  P             Paste before cursor/line\n");
-  fprintf(out, "  u             Undo (limited)\n");
+  fprintf(out, "  u             Undo\n");
+  fprintf(out, "  Ctrl-R        Redo\n");
+  fprintf(out, "  g-, g+        Go to older/newer text state, across undo "
+               "branches\n");
   fprintf(out, "  :             Enter command mode\n");
-  fprintf(out, "  /             Search forward\n");
+  fprintf(out, "  /             Search forward for a regular expression\n");
+  fprintf(out, "  n             Repeat the last search\n");
   fprintf(out, "\nCommand mode:\n");
   fprintf(out, "  :w            Write file\n");
   fprintf(out, "  :q            Quit (fails if modified)\n");
   fprintf(out, "  :q!           Quit without saving\n");
   fprintf(out, "  :wq           Write and quit\n");
   fprintf(out, "  :e FILE       Edit FILE\n");
+  fprintf(out, "  :%%s/RE/TEXT/g Replace RE with TEXT throughout\n");
+  cleanup_vi_argtable(&args);
+}
+
+
+/**
+ * Passes the vi argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void vi_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  vi_args_t args;
+  build_vi_argtable(&args);
+  visit(args.argtable, userdata);
   cleanup_vi_argtable(&args);
 }
 
@@ -183,6 +238,7 @@ static void handle_sigterm(int sig) {
  * Disables raw terminal mode and restores original settings.
  */
 static void disable_raw_mode(void) {
+  write(STDOUT_FILENO, "\x1b[?2004l", 8);
   tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios);
 }
 
@@ -210,6 +266,10 @@ static int enable_raw_mode(void) {
     return -1;
   }
 
+  /* Bracketed paste: the terminal marks pasted text, see vi_paste() */
+  write(STDOUT_FILENO, "\x1b[?2004h", 8);
+  input_len = input_pos = 0;
+
   return 0;
 }
 
@@ -232,156 +292,143 @@ static void get_terminal_size(int *rows, int *cols) {
 
 
 /**
- * Initializes a line structure.
- * @param line Pointer to line to initialize
+ * Initializes the editor state.
+ * @param state Pointer to state structure to initialize
+ * @return 0 on success, -1 if out of memory
  */
-static void vi_line_init(vi_line_t *line) {
-  line->capacity = 64;
-  line->text = malloc(line->capacity);
-  line->text[0] = '\0';
-  line->len = 0;
+static int vi_state_init(vi_state_t *state) {
+  state->buf = vi_buffer_new();
+  state->swap = NULL;
+  state->undo = vi_undo_new(VI_UNDO_LEVELS);
+  state->saved_seq = state->undo ? vi_undo_seq(state->undo) : 0;
+  state->line_count = 1;
+  state->cursor_row = 0;
+  state->cursor_col = 0;
+  state->top_line = 0;
+  state->mode = MODE_NORMAL;
+  state->filename = NULL;
+  state->modified = 0;
+  state->status_msg[0] = '\0';
+  state->command_buf[0] = '\0';
+  state->command_len = 0;
+  state->search_pat = NULL;
+  state->search_str[0] = '\0';
+  state->yank_buf[0] = '\0';
+  state->yank_is_line = 0;
+  state->screen = NULL;
+  get_terminal_size(&state->rows, &state->cols);
+  return state->buf && state->undo ? 0 : -1;
 }
 
 
 /**
- * Frees memory associated with a line.
- * @param line Pointer to line to free
+ * Frees all memory associated with editor state.
+ * @param state Pointer to state structure to free
  */
-static void vi_line_free(vi_line_t *line) {
-  free(line->text);
-  line->text = NULL;
-  line->len = 0;
-  line->capacity = 0;
+static void vi_state_free(vi_state_t *state) {
+  vi_swap_close(state->swap, 0);
+  vi_undo_free(state->undo);
+  vi_pattern_free(state->search_pat);
+  vi_buffer_free(state->buf);
+  free(state->filename);
+  jbox_screen_free(state->screen);
 }
 
 
 /**
- * Ensures a line has sufficient capacity for specified size.
- * @param line Pointer to line
- * @param needed Required capacity
+ * Returns the text of a line, valid until the next edit.
+ * @param state Pointer to state structure
+ * @param row Line number
+ * @param len Set to the length of the line
+ * @return Line text, not NUL-terminated
  */
-static void vi_line_ensure_capacity(vi_line_t *line, size_t needed) {
-  if (needed >= line->capacity) {
-    size_t new_cap = line->capacity * 2;
-    if (new_cap < needed + 1) new_cap = needed + 1;
-    char *new_text = realloc(line->text, new_cap);
-    if (new_text) {
-      line->text = new_text;
-      line->capacity = new_cap;
-    }
-  }
+static const char *vi_line_text(vi_state_t *state, size_t row, size_t *len) {
+  return vi_buffer_line(state->buf, row, len);
 }
 
 
 /**
- * Inserts a character at specified position in a line.
- * @param line Pointer to line
- * @param pos Position to insert at
- * @param c Character to insert
+ * Returns the length of a line.
+ * @param state Pointer to state structure
+ * @param row Line number
+ * @return Length in bytes
  */
-static void vi_line_insert_char(vi_line_t *line, size_t pos, char c) {
-  vi_line_ensure_capacity(line, line->len + 1);
-  if (pos > line->len) pos = line->len;
-  memmove(line->text + pos + 1, line->text + pos, line->len - pos + 1);
-  line->text[pos] = c;
-  line->len++;
+static size_t vi_line_len(vi_state_t *state, size_t row) {
+  return vi_buffer_line_length(state->buf, row);
 }
 
 
 /**
- * Deletes a character at specified position in a line.
- * @param line Pointer to line
- * @param pos Position to delete from
+ * Returns the byte offset of a position in the text.
+ * @param state Pointer to state structure
+ * @param row Line number
+ * @param col Column within the line
+ * @return Offset in bytes
  */
-static void vi_line_delete_char(vi_line_t *line, size_t pos) {
-  if (pos >= line->len) return;
-  memmove(line->text + pos, line->text + pos + 1, line->len - pos);
-  line->len--;
+static size_t vi_offset(vi_state_t *state, size_t row, size_t col) {
+  return vi_buffer_line_start(state->buf, row) + col;
 }
 
 
 /**
- * Sets the content of a line.
- * @param line Pointer to line
- * @param text Text to set
+ * Inserts text at a byte offset.
+ * @param state Pointer to state structure
+ * @param pos Offset to insert at
+ * @param text Text to insert
  * @param len Length of text
  */
-static void vi_line_set(vi_line_t *line, const char *text, size_t len) {
-  vi_line_ensure_capacity(line, len);
-  memcpy(line->text, text, len);
-  line->text[len] = '\0';
-  line->len = len;
-}
-
-
-/**
- * Initializes the editor state.
- * @param state Pointer to state structure to initialize
- */
-static void vi_state_init(vi_state_t *state) {
-  state->line_capacity = 256;
-  state->lines = malloc(state->line_capacity * sizeof(vi_line_t));
-  state->line_count = 1;
-  vi_line_init(&state->lines[0]);
-  state->cursor_row = 0;
-  state->cursor_col = 0;
-  state->top_line = 0;
-  state->mode = MODE_NORMAL;
-  state->filename = NULL;
-  state->modified = 0;
-  state->status_msg[0] = '\0';
-  state->command_buf[0] = '\0';
-  state->command_len = 0;
-  state->yank_buf[0] = '\0';
-  state->yank_is_line = 0;
-  get_terminal_size(&state->rows, &state->cols);
-}
-
-
-/**
- * Frees all memory associated with editor state.
- * @param state Pointer to state structure to free
- */
-static void vi_state_free(vi_state_t *state) {
-  for (size_t i = 0; i < state->line_count; i++) {
-    vi_line_free(&state->lines[i]);
+static void vi_insert_text(vi_state_t *state, size_t pos, const char *text,
+                           size_t len) {
+  if (vi_buffer_insert(state->buf, pos, text, len) == -1) {
+    snprintf(state->status_msg, sizeof(state->status_msg), "Out of memory");
+    return;
   }
-  free(state->lines);
-  free(state->filename);
+  vi_swap_insert(state->swap, pos, text, len);
+  if (vi_undo_insert(state->undo, pos, len) == -1) {
+    snprintf(state->status_msg, sizeof(state->status_msg),
+             "Out of memory; undo history lost");
+  }
+  state->line_count = vi_buffer_line_count(state->buf);
+  state->modified = 1;
 }
 
 
 /**
- * Ensures the editor has capacity for specified number of lines.
+ * Deletes text at a byte offset, keeping it for undo.
  * @param state Pointer to state structure
- * @param needed Required line capacity
- */
-static void vi_ensure_line_capacity(vi_state_t *state, size_t needed) {
-  if (needed >= state->line_capacity) {
-    size_t new_cap = state->line_capacity * 2;
-    if (new_cap < needed + 1) new_cap = needed + 1;
-    vi_line_t *new_lines = realloc(state->lines, new_cap * sizeof(vi_line_t));
-    if (new_lines) {
-      state->lines = new_lines;
-      state->line_capacity = new_cap;
-    }
+ * @param pos Offset of the first byte to delete
+ * @param len Number of bytes to delete
+ */
+static void vi_delete_text(vi_state_t *state, size_t pos, size_t len) {
+  size_t size = vi_buffer_size(state->buf);
+  if (pos >= size) return;
+  if (len > size - pos) len = size - pos;
+  vi_cut_t *cut;
+  if (vi_buffer_cut(state->buf, pos, len, &cut) == -1) {
+    snprintf(state->status_msg, sizeof(state->status_msg), "Out of memory");
+    return;
   }
+  vi_swap_delete(state->swap, pos, len);
+  if (vi_undo_delete(state->undo, pos, cut) == -1) {
+    snprintf(state->status_msg, sizeof(state->status_msg),
+             "Out of memory; undo history lost");
+  }
+  state->line_count = vi_buffer_line_count(state->buf);
+  state->modified = 1;
 }
 
 
 /**
- * Inserts a new line at specified position.
+ * Inserts a new empty line at specified position.
  * @param state Pointer to state structure
  * @param pos Position to insert new line
  */
 static void vi_insert_line(vi_state_t *state, size_t pos) {
-  vi_ensure_line_capacity(state, state->line_count + 1);
-  if (pos > state->line_count) pos = state->line_count;
-  memmove(&state->lines[pos + 1], &state->lines[pos],
-          (state->line_count - pos) * sizeof(vi_line_t));
-  vi_line_init(&state->lines[pos]);
-  state->line_count++;
-  state->modified = 1;
+  if (pos >= state->line_count) {
+    vi_insert_text(state, vi_buffer_size(state->buf), "\n", 1);
+  } else {
+    vi_insert_text(state, vi_buffer_line_start(state->buf, pos), "\n", 1);
+  }
 }
 
 
@@ -392,16 +439,39 @@ static void vi_insert_line(vi_state_t *state, size_t pos) {
  */
 static void vi_delete_line(vi_state_t *state, size_t pos) {
   if (state->line_count <= 1) {
-    vi_line_set(&state->lines[0], "", 0);
-    state->modified = 1;
+    vi_delete_text(state, 0, vi_buffer_size(state->buf));
     return;
   }
   if (pos >= state->line_count) return;
-  vi_line_free(&state->lines[pos]);
-  memmove(&state->lines[pos], &state->lines[pos + 1],
-          (state->line_count - pos - 1) * sizeof(vi_line_t));
-  state->line_count--;
-  state->modified = 1;
+
+  size_t start = vi_buffer_line_start(state->buf, pos);
+  if (pos + 1 < state->line_count) {
+    vi_delete_text(state, start,
+                   vi_buffer_line_start(state->buf, pos + 1) - start);
+  } else {
+    /* The last line takes the newline before it */
+    vi_delete_text(state, start - 1, vi_buffer_size(state->buf) - start + 1);
+  }
+}
+
+
+/**
+ * Starts journaling edits to the current file's swap file. A swap file
+ * left by an earlier session is never overwritten; the editor then runs
+ * without one until the user recovers or removes it.
+ * @param state Pointer to state structure
+ * @param resume Non-zero to append to the journal just recovered from
+ */
+static void vi_swap_start(vi_state_t *state, int resume) {
+  vi_swap_close(state->swap, 0);
+  state->swap = NULL;
+  if (!state->filename) return;
+
+  state->swap = vi_swap_open(state->filename, resume);
+  if (!state->swap && errno == EEXIST) {
+    snprintf(state->status_msg, sizeof(state->status_msg),
+             "Found %.200s.swp; recover with vi -r", state->filename);
+  }
 }
 
 
@@ -412,58 +482,100 @@ static void vi_delete_line(vi_state_t *state, size_t pos) {
  * @return 0 on success, -1 on error
  */
 static int vi_load_file(vi_state_t *state, const char *path) {
-  FILE *fp = fopen(path, "r");
-  if (!fp) {
+  if (vi_buffer_load(state->buf, path) == -1) {
     if (errno == ENOENT) {
       free(state->filename);
       state->filename = strdup(path);
       snprintf(state->status_msg, sizeof(state->status_msg),
                "\"%s\" [New File]", path);
+      vi_swap_start(state, 0);
       return 0;
     }
     return -1;
   }
 
-  for (size_t i = 0; i < state->line_count; i++) {
-    vi_line_free(&state->lines[i]);
-  }
-  state->line_count = 0;
-
-  char buf[4096];
-  while (fgets(buf, sizeof(buf), fp)) {
-    size_t len = strlen(buf);
-    if (len > 0 && buf[len - 1] == '\n') {
-      buf[len - 1] = '\0';
-      len--;
-    }
-    vi_ensure_line_capacity(state, state->line_count + 1);
-    vi_line_init(&state->lines[state->line_count]);
-    vi_line_set(&state->lines[state->line_count], buf, len);
-    state->line_count++;
-  }
-
-  fclose(fp);
-
-  if (state->line_count == 0) {
-    vi_line_init(&state->lines[0]);
-    state->line_count = 1;
-  }
-
+  state->line_count = vi_buffer_line_count(state->buf);
   free(state->filename);
   state->filename = strdup(path);
   state->cursor_row = 0;
   state->cursor_col = 0;
   state->top_line = 0;
+  vi_undo_clear(state->undo);
+  state->saved_seq = vi_undo_seq(state->undo);
   state->modified = 0;
   snprintf(state->status_msg, sizeof(state->status_msg),
            "\"%s\" %zuL", path, state->line_count);
+  vi_swap_start(state, 0);
+
+  return 0;
+}
+
+
+/**
+ * Writes the whole text, and a final newline, to a file. The pieces of
+ * the text go straight from the mapping and the append buffer to
+ * writev(), many at a time, without being copied.
+ * @param state Pointer to state structure
+ * @param fd File to write to
+ * @return 0 on success, -1 on error (errno set)
+ */
+static int vi_write_text(vi_state_t *state, int fd) {
+  size_t size = vi_buffer_size(state->buf);
+  size_t pos = 0;             /* Bytes written, the newline counting last */
+  struct iovec iov[VI_SAVE_IOV];
+
+  while (pos <= size) {
+    size_t count = vi_buffer_spans(state->buf, pos, iov, VI_SAVE_IOV - 1);
+    size_t bytes = 0;
+    for (size_t i = 0; i < count; i++) bytes += iov[i].iov_len;
+    if (pos + bytes == size) {
+      iov[count].iov_base = "\n";
+      iov[count].iov_len = 1;
+      count++;
+    }
 
+    ssize_t n = writev(fd, iov, (int)count);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    pos += (size_t)n;
+  }
   return 0;
 }
 
 
+/**
+ * Flushes a directory, so that a rename in it survives a crash.
+ * @param path File in the directory
+ */
+static void vi_sync_dir(const char *path) {
+  char dir[PATH_MAX];
+  const char *slash = strrchr(path, '/');
+  if (!slash) {
+    strcpy(dir, ".");
+  } else if (slash == path) {
+    strcpy(dir, "/");
+  } else {
+    snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+  }
+  int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd != -1) {
+    fsync(fd);
+    close(fd);
+  }
+}
+
+
 /**
  * Saves the current file.
+ *
+ * The text is written to a temporary file next to the target, synced,
+ * and renamed over it, so the target is always either the old or the
+ * new version. The file being edited is mapped by the buffer, so it
+ * must never be truncated and rewritten in place. The journal then
+ * starts over from the saved file.
+ *
  * @param state Pointer to state structure
  * @return 0 on success, -1 on error
  */
@@ -474,19 +586,52 @@ static int vi_save_file(vi_state_t *state) {
     return -1;
   }
 
-  FILE *fp = fopen(state->filename, "w");
-  if (!fp) {
+  /* Write beside the file a symlink points to, not over the link */
+  char resolved[PATH_MAX];
+  const char *target = state->filename;
+  if (realpath(state->filename, resolved)) target = resolved;
+
+  mode_t mode;
+  struct stat st;
+  if (stat(target, &st) == 0) {
+    mode = st.st_mode & 07777;
+  } else {
+    mode_t mask = umask(0);
+    umask(mask);
+    mode = 0666 & ~mask;
+  }
+
+  char tmp[PATH_MAX];
+  if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", target) >= (int)sizeof(tmp)) {
+    snprintf(state->status_msg, sizeof(state->status_msg),
+             "Cannot write: %s", strerror(ENAMETOOLONG));
+    return -1;
+  }
+  int fd = mkstemp(tmp);
+  if (fd == -1) {
     snprintf(state->status_msg, sizeof(state->status_msg),
              "Cannot write: %s", strerror(errno));
     return -1;
   }
 
-  for (size_t i = 0; i < state->line_count; i++) {
-    fprintf(fp, "%s\n", state->lines[i].text);
+  int failed = fchmod(fd, mode) == -1 || vi_write_text(state, fd) == -1 ||
+               fsync(fd) == -1;
+  if (close(fd) == -1) failed = 1;
+  if (failed || rename(tmp, target) == -1) {
+    snprintf(state->status_msg, sizeof(state->status_msg),
+             "Cannot write: %s", strerror(errno));
+    unlink(tmp);
+    return -1;
   }
+  vi_sync_dir(target);
 
-  fclose(fp);
+  state->saved_seq = vi_undo_seq(state->undo);
   state->modified = 0;
+  if (state->swap) {
+    vi_swap_reset(state->swap, state->filename);
+  } else {
+    vi_swap_start(state, 0);
+  }
   snprintf(state->status_msg, sizeof(state->status_msg),
            "\"%s\" %zuL written", state->filename, state->line_count);
   return 0;
@@ -501,10 +646,10 @@ static void vi_clamp_cursor(vi_state_t *state) {
   if (state->cursor_row >= state->line_count) {
     state->cursor_row = state->line_count > 0 ? state->line_count - 1 : 0;
   }
-  vi_line_t *line = &state->lines[state->cursor_row];
-  size_t max_col = line->len > 0 ? line->len - 1 : 0;
+  size_t len = vi_line_len(state, state->cursor_row);
+  size_t max_col = len > 0 ? len - 1 : 0;
   if (state->mode == MODE_INSERT) {
-    max_col = line->len;
+    max_col = len;
   }
   if (state->cursor_col > max_col) {
     state->cursor_col = max_col;
@@ -528,23 +673,6 @@ static void vi_scroll_to_cursor(vi_state_t *state) {
 }
 
 
-/**
- * Clears the terminal screen.
- */
-static void clear_screen(void) {
-  write(STDOUT_FILENO, "\x1b[2J", 4);
-  write(STDOUT_FILENO, "\x1b[H", 3);
-}
-
-
-/**
- * Hides the terminal cursor.
- */
-static void hide_cursor(void) {
-  write(STDOUT_FILENO, "\x1b[?25l", 6);
-}
-
-
 /**
  * Shows the terminal cursor.
  */
@@ -573,84 +701,33 @@ static void vi_suspend(void) {
 
 
 /**
- * Performs an emergency save to a swap file.
+ * Performs an emergency save: the journal of unsaved edits is flushed
+ * and its swap file kept, which costs only the edits not yet written.
  * @param state Pointer to state structure
  */
 static void vi_emergency_save(vi_state_t *state) {
-  if (state->modified && state->filename) {
-    char backup[512];
-    snprintf(backup, sizeof(backup), "%s.swp", state->filename);
-    FILE *fp = fopen(backup, "w");
-    if (fp) {
-      for (size_t i = 0; i < state->line_count; i++) {
-        fprintf(fp, "%s\n", state->lines[i].text);
-      }
-      fclose(fp);
-    }
-  }
-}
-
-
-/**
- * Moves the terminal cursor to specified position.
- * @param row Row position (1-based)
- * @param col Column position (1-based)
- */
-static void move_cursor(int row, int col) {
-  char buf[32];
-  int len = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", row, col);
-  write(STDOUT_FILENO, buf, (size_t)len);
-}
-
-
-/**
- * Clears the current terminal line.
- */
-static void clear_line(void) {
-  write(STDOUT_FILENO, "\x1b[K", 3);
-}
-
-
-/**
- * Sets terminal to reverse video mode.
- */
-static void set_reverse_video(void) {
-  write(STDOUT_FILENO, "\x1b[7m", 4);
-}
-
-
-/**
- * Resets terminal video attributes to normal.
- */
-static void reset_video(void) {
-  write(STDOUT_FILENO, "\x1b[0m", 4);
+  vi_swap_close(state->swap, state->modified);
+  state->swap = NULL;
 }
 
 
 /**
  * Draws a single row of the editor.
  * @param state Pointer to state structure
- * @param screen_row Screen row position
+ * @param screen_row Screen row position (0-based)
  * @param file_row File line number to display
  */
 static void vi_draw_row(vi_state_t *state, int screen_row, size_t file_row) {
-  move_cursor(screen_row, 1);
-  clear_line();
+  jbox_screen_clear_row(state->screen, screen_row);
 
   if (file_row >= state->line_count) {
-    write(STDOUT_FILENO, "~", 1);
+    jbox_screen_put(state->screen, screen_row, 0, "~", 1, 0);
     return;
   }
 
-  vi_line_t *line = &state->lines[file_row];
-  size_t display_len = line->len;
-  if ((int)display_len > state->cols) {
-    display_len = (size_t)state->cols;
-  }
-
-  if (display_len > 0) {
-    write(STDOUT_FILENO, line->text, display_len);
-  }
+  size_t len;
+  const char *text = vi_line_text(state, file_row, &len);
+  jbox_screen_put(state->screen, screen_row, 0, text, len, 0);
 }
 
 
@@ -659,9 +736,8 @@ static void vi_draw_row(vi_state_t *state, int screen_row, size_t file_row) {
  * @param state Pointer to state structure
  */
 static void vi_draw_status_bar(vi_state_t *state) {
-  move_cursor(state->rows - 1, 1);
-  set_reverse_video();
-  clear_line();
+  int row = state->rows - 2;
+  jbox_screen_clear_row(state->screen, row);
 
   char left[128];
   char right[64];
@@ -685,16 +761,16 @@ static void vi_draw_status_bar(vi_state_t *state) {
                           mode_str);
   int right_len = snprintf(right, sizeof(right), "%zu/%zu ",
                            state->cursor_row + 1, state->line_count);
+  if (left_len >= (int)sizeof(left)) left_len = (int)sizeof(left) - 1;
 
-  write(STDOUT_FILENO, left, (size_t)left_len);
-
-  int padding = state->cols - left_len - right_len;
-  for (int i = 0; i < padding; i++) {
-    write(STDOUT_FILENO, " ", 1);
+  int col = jbox_screen_put(state->screen, row, 0, left, (size_t)left_len,
+                            JBOX_SCREEN_REVERSE);
+  while (col < state->cols - right_len) {
+    col = jbox_screen_put(state->screen, row, col, " ", 1,
+                          JBOX_SCREEN_REVERSE);
   }
-  write(STDOUT_FILENO, right, (size_t)right_len);
-
-  reset_video();
+  jbox_screen_put(state->screen, row, col, right, (size_t)right_len,
+                  JBOX_SCREEN_REVERSE);
 }
 
 
@@ -703,44 +779,40 @@ static void vi_draw_status_bar(vi_state_t *state) {
  * @param state Pointer to state structure
  */
 static void vi_draw_message_bar(vi_state_t *state) {
-  move_cursor(state->rows, 1);
-  clear_line();
-
-  if (state->mode == MODE_COMMAND) {
-    write(STDOUT_FILENO, ":", 1);
-    write(STDOUT_FILENO, state->command_buf, state->command_len);
-  } else if (state->mode == MODE_SEARCH) {
-    write(STDOUT_FILENO, "/", 1);
-    write(STDOUT_FILENO, state->command_buf, state->command_len);
+  int row = state->rows - 1;
+  jbox_screen_clear_row(state->screen, row);
+
+  if (state->mode == MODE_COMMAND || state->mode == MODE_SEARCH) {
+    const char *prompt = state->mode == MODE_COMMAND ? ":" : "/";
+    int col = jbox_screen_put(state->screen, row, 0, prompt, 1, 0);
+    jbox_screen_put(state->screen, row, col, state->command_buf,
+                    state->command_len, 0);
   } else if (state->status_msg[0] != '\0') {
-    size_t msg_len = strlen(state->status_msg);
-    if ((int)msg_len > state->cols) msg_len = (size_t)state->cols;
-    write(STDOUT_FILENO, state->status_msg, msg_len);
+    jbox_screen_put(state->screen, row, 0, state->status_msg,
+                    strlen(state->status_msg), 0);
   }
 }
 
 
 /**
- * Draws the entire editor screen.
+ * Draws the entire editor screen. Only the cells that differ from what
+ * the terminal already shows are sent, in one write.
  * @param state Pointer to state structure
  */
 static void vi_draw_screen(vi_state_t *state) {
-  hide_cursor();
-
   int text_rows = state->rows - 2;
   for (int i = 0; i < text_rows; i++) {
     size_t file_row = state->top_line + (size_t)i;
-    vi_draw_row(state, i + 1, file_row);
+    vi_draw_row(state, i, file_row);
   }
 
   vi_draw_status_bar(state);
   vi_draw_message_bar(state);
 
-  int screen_row = (int)(state->cursor_row - state->top_line) + 1;
-  int screen_col = (int)state->cursor_col + 1;
-  move_cursor(screen_row, screen_col);
-
-  show_cursor();
+  int screen_row = (int)(state->cursor_row - state->top_line);
+  int screen_col = (int)state->cursor_col;
+  jbox_screen_set_cursor(state->screen, screen_row, screen_col);
+  jbox_screen_flush(state->screen);
 }
 
 
@@ -753,43 +825,140 @@ enum {
   KEY_PAGE_DOWN,
   KEY_HOME,
   KEY_END,
-  KEY_DEL
+  KEY_DEL,
+  KEY_PASTE,
+  KEY_NONE
 };
 
 
+/**
+ * Reads more terminal input once what was read before is used up.
+ * @return 1 if input is buffered, 0 if none came within the read
+ *         timeout, -1 on error
+ */
+static int vi_input_fill(void) {
+  if (input_pos < input_len) return 1;
+  input_pos = input_len = 0;
+  ssize_t n = read(STDIN_FILENO, input_buf, sizeof(input_buf));
+  if (n <= 0) return (int)n;
+  input_len = (size_t)n;
+  return 1;
+}
+
+
+/**
+ * Takes the next byte of terminal input.
+ * @param c Where to store the byte
+ * @return 1 on success, 0 if none came within the read timeout, -1 on
+ *         error
+ */
+static int vi_input_byte(char *c) {
+  int ret = vi_input_fill();
+  if (ret == 1) *c = input_buf[input_pos++];
+  return ret;
+}
+
+
+/**
+ * Checks for input not handled yet, read or still in the terminal.
+ * @return 1 if there is some, 0 if not
+ */
+static int vi_input_pending(void) {
+  if (input_pos < input_len) return 1;
+  struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+  return poll(&pfd, 1, 0) > 0;
+}
+
+
+/**
+ * Waits for input and reads what came behind the input not handled yet,
+ * as far as it fits.
+ * @param timeout Most milliseconds to wait
+ */
+static void vi_input_wait(int timeout) {
+  if (input_pos > 0) {
+    memmove(input_buf, input_buf + input_pos, input_len - input_pos);
+    input_len -= input_pos;
+    input_pos = 0;
+  }
+  if (input_len == sizeof(input_buf)) {
+    poll(NULL, 0, timeout);
+    return;
+  }
+
+  struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+  if (poll(&pfd, 1, timeout) > 0) {
+    ssize_t n = read(STDIN_FILENO, input_buf + input_len,
+                     sizeof(input_buf) - input_len);
+    if (n > 0) input_len += (size_t)n;
+  }
+}
+
+
+/**
+ * Takes the printable characters that follow in input already read,
+ * as typed ahead or pasted by a terminal without bracketed paste.
+ * @param out Where to copy them
+ * @param max Most to take
+ * @return Number taken
+ */
+static size_t vi_input_take_text(char *out, size_t max) {
+  size_t n = 0;
+  while (n < max && input_pos < input_len &&
+         input_buf[input_pos] >= 32 && input_buf[input_pos] < 127) {
+    out[n++] = input_buf[input_pos++];
+  }
+  return n;
+}
+
+
 /**
  * Reads a key from the terminal.
- * @return Key code, -1 on error, -2 on terminal resize
+ * @return Key code, -1 on error, -2 on terminal resize, -3 if no key
+ *         came within the read timeout
  */
 static int vi_read_key(void) {
   char c;
   int nread;
-  while ((nread = (int)read(STDIN_FILENO, &c, 1)) != 1) {
+  while ((nread = vi_input_byte(&c)) != 1) {
     if (nread == -1 && errno != EAGAIN) return -1;
     if (term_resized) return -2;
+    if (nread == 0) return -3;
   }
 
   if (c == '\x1b') {
-    char seq[3];
-    if (read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b';
-    if (read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';
-
-    if (seq[0] == '[') {
-      if (seq[1] >= '0' && seq[1] <= '9') {
-        if (read(STDIN_FILENO, &seq[2], 1) != 1) return '\x1b';
-        if (seq[2] == '~') {
-          switch (seq[1]) {
-            case '1': return KEY_HOME;
-            case '3': return KEY_DEL;
-            case '4': return KEY_END;
-            case '5': return KEY_PAGE_UP;
-            case '6': return KEY_PAGE_DOWN;
-            case '7': return KEY_HOME;
-            case '8': return KEY_END;
+    /* Only a sequence's introducer is taken, so ESC typed ahead of a
+     * command leaves the command to be read next */
+    if (vi_input_fill() != 1) return '\x1b';
+    char intro = input_buf[input_pos];
+    if (intro != '[' && intro != 'O') return '\x1b';
+    input_pos++;
+
+    char seq;
+    if (vi_input_byte(&seq) != 1) return '\x1b';
+
+    if (intro == '[') {
+      if (seq >= '0' && seq <= '9') {
+        int num = 0;
+        while (seq >= '0' && seq <= '9') {
+          if (num < 1000) num = num * 10 + (seq - '0');
+          if (vi_input_byte(&seq) != 1) return '\x1b';
+        }
+        if (seq == '~') {
+          switch (num) {
+            case 1: return KEY_HOME;
+            case 3: return KEY_DEL;
+            case 4: return KEY_END;
+            case 5: return KEY_PAGE_UP;
+            case 6: return KEY_PAGE_DOWN;
+            case 7: return KEY_HOME;
+            case 8: return KEY_END;
+            case 200: return KEY_PASTE;
+            case 201: return KEY_NONE;
           }
         }
       } else {
-        switch (seq[1]) {
+        switch (seq) {
           case 'A': return KEY_ARROW_UP;
           case 'B': return KEY_ARROW_DOWN;
           case 'C': return KEY_ARROW_RIGHT;
@@ -798,8 +967,8 @@ static int vi_read_key(void) {
           case 'F': return KEY_END;
         }
       }
-    } else if (seq[0] == 'O') {
-      switch (seq[1]) {
+    } else {
+      switch (seq) {
         case 'H': return KEY_HOME;
         case 'F': return KEY_END;
       }
@@ -811,6 +980,105 @@ static int vi_read_key(void) {
 }
 
 
+/**
+ * Appends to the text of a paste.
+ * @param text Pointer to the paste's text
+ * @param len Pointer to its length
+ * @param cap Pointer to the size allocated for it
+ * @param add Text to append
+ * @param add_len Length of add
+ * @return 0 on success, -1 if out of memory
+ */
+static int vi_paste_append(char **text, size_t *len, size_t *cap,
+                           const char *add, size_t add_len) {
+  if (*len + add_len > *cap) {
+    size_t new_cap = *cap ? *cap : VI_INPUT_SIZE;
+    while (new_cap < *len + add_len) new_cap *= 2;
+    char *grown = realloc(*text, new_cap);
+    if (!grown) return -1;
+    *text = grown;
+    *cap = new_cap;
+  }
+  memcpy(*text + *len, add, add_len);
+  *len += add_len;
+  return 0;
+}
+
+
+/**
+ * Reads pasted text up to the terminal's end of paste marker.
+ * Line ends arrive as carriage returns and are turned into newlines.
+ * @param out Where to store the text, to be freed; NULL if empty
+ * @param len Where to store the length of the text
+ * @return 0 on success, -1 if out of memory
+ */
+static int vi_read_paste(char **out, size_t *len) {
+  static const char end[] = "\x1b[201~";
+  const size_t end_len = sizeof(end) - 1;
+  char *text = NULL;
+  size_t cap = 0;
+  size_t matched = 0;
+  int idle = 0;
+  int failed = 0;
+
+  *len = 0;
+  while (matched < end_len) {
+    int ret = vi_input_fill();
+    if (ret == 0 && ++idle < VI_PASTE_IDLE) continue;
+    if (ret == -1 && (errno == EINTR || errno == EAGAIN)) continue;
+    if (ret != 1) break;
+    idle = 0;
+
+    if (matched == 0) {
+      /* Everything up to the next ESC is text, taken as one run */
+      const char *from = input_buf + input_pos;
+      size_t avail = input_len - input_pos;
+      const char *esc = memchr(from, '\x1b', avail);
+      size_t run = esc ? (size_t)(esc - from) : avail;
+      if (run > 0) {
+        /* Past running out of memory the rest is still read, so that it
+         * does not arrive as keys */
+        if (!failed) failed = vi_paste_append(&text, len, &cap, from, run);
+        input_pos += run;
+        continue;
+      }
+    }
+
+    char c = input_buf[input_pos++];
+    if (c == end[matched]) {
+      matched++;
+      continue;
+    }
+    /* What looked like the marker's start was text after all */
+    if (!failed) failed = vi_paste_append(&text, len, &cap, end, matched);
+    matched = c == end[0] ? 1 : 0;
+    if (!failed && !matched) {
+      failed = vi_paste_append(&text, len, &cap, &c, 1);
+    }
+  }
+
+  *out = NULL;
+  if (failed) {
+    free(text);
+    *len = 0;
+    return -1;
+  }
+
+  size_t kept = 0;
+  for (size_t i = 0; i < *len; i++) {
+    if (text[i] == '\r') {
+      text[kept++] = '\n';
+      if (i + 1 < *len && text[i + 1] == '\n') i++;
+    } else {
+      text[kept++] = text[i];
+    }
+  }
+  *len = kept;
+  *out = text;
+  return 0;
+}
+
+
 /**
  * Checks if a character is a word character.
  * @param c Character to check
@@ -826,25 +1094,24 @@ static int is_word_char(char c) {
  * @param state Pointer to state structure
  */
 static void vi_move_word_forward(vi_state_t *state) {
-  vi_line_t *line = &state->lines[state->cursor_row];
+  size_t len;
+  const char *text = vi_line_text(state, state->cursor_row, &len);
 
-  while (state->cursor_col < line->len &&
-         is_word_char(line->text[state->cursor_col])) {
+  while (state->cursor_col < len && is_word_char(text[state->cursor_col])) {
     state->cursor_col++;
   }
 
-  while (state->cursor_col < line->len &&
-         !is_word_char(line->text[state->cursor_col])) {
+  while (state->cursor_col < len && !is_word_char(text[state->cursor_col])) {
     state->cursor_col++;
   }
 
-  if (state->cursor_col >= line->len &&
+  if (state->cursor_col >= len &&
       state->cursor_row < state->line_count - 1) {
     state->cursor_row++;
     state->cursor_col = 0;
-    line = &state->lines[state->cursor_row];
-    while (state->cursor_col < line->len &&
-           !is_word_char(line->text[state->cursor_col])) {
+    text = vi_line_text(state, state->cursor_row, &len);
+    while (state->cursor_col < len &&
+           !is_word_char(text[state->cursor_col])) {
       state->cursor_col++;
     }
   }
@@ -858,20 +1125,20 @@ static void vi_move_word_forward(vi_state_t *state) {
 static void vi_move_word_backward(vi_state_t *state) {
   if (state->cursor_col == 0 && state->cursor_row > 0) {
     state->cursor_row--;
-    state->cursor_col = state->lines[state->cursor_row].len;
+    state->cursor_col = vi_line_len(state, state->cursor_row);
   }
 
-  vi_line_t *line = &state->lines[state->cursor_row];
+  size_t len;
+  const char *text = vi_line_text(state, state->cursor_row, &len);
+  if (state->cursor_col > len) state->cursor_col = len;
 
   if (state->cursor_col > 0) state->cursor_col--;
 
-  while (state->cursor_col > 0 &&
-         !is_word_char(line->text[state->cursor_col])) {
+  while (state->cursor_col > 0 && !is_word_char(text[state->cursor_col])) {
     state->cursor_col--;
   }
 
-  while (state->cursor_col > 0 &&
-         is_word_char(line->text[state->cursor_col - 1])) {
+  while (state->cursor_col > 0 && is_word_char(text[state->cursor_col - 1])) {
     state->cursor_col--;
   }
 }
@@ -882,12 +1149,12 @@ static void vi_move_word_backward(vi_state_t *state) {
  * @param state Pointer to state structure
  */
 static void vi_yank_line(vi_state_t *state) {
-  vi_line_t *line = &state->lines[state->cursor_row];
-  size_t copy_len = line->len;
+  size_t copy_len;
+  const char *text = vi_line_text(state, state->cursor_row, &copy_len);
   if (copy_len >= sizeof(state->yank_buf)) {
     copy_len = sizeof(state->yank_buf) - 1;
   }
-  memcpy(state->yank_buf, line->text, copy_len);
+  memcpy(state->yank_buf, text, copy_len);
   state->yank_buf[copy_len] = '\0';
   state->yank_is_line = 1;
   snprintf(state->status_msg, sizeof(state->status_msg), "1 line yanked");
@@ -901,20 +1168,21 @@ static void vi_yank_line(vi_state_t *state) {
 static void vi_paste_after(vi_state_t *state) {
   if (state->yank_buf[0] == '\0') return;
 
+  size_t yank_len = strlen(state->yank_buf);
   if (state->yank_is_line) {
-    vi_insert_line(state, state->cursor_row + 1);
-    vi_line_set(&state->lines[state->cursor_row + 1],
-                state->yank_buf, strlen(state->yank_buf));
+    /* Newline first, so that pasting after the last line works too */
+    size_t end = vi_offset(state, state->cursor_row,
+                           vi_line_len(state, state->cursor_row));
+    vi_insert_text(state, end, "\n", 1);
+    vi_insert_text(state, end + 1, state->yank_buf, yank_len);
     state->cursor_row++;
     state->cursor_col = 0;
   } else {
-    vi_line_t *line = &state->lines[state->cursor_row];
     size_t pos = state->cursor_col;
-    if (pos < line->len) pos++;
-    for (size_t i = 0; state->yank_buf[i] != '\0'; i++) {
-      vi_line_insert_char(line, pos + i, state->yank_buf[i]);
-    }
-    state->cursor_col = pos + strlen(state->yank_buf) - 1;
+    if (pos < vi_line_len(state, state->cursor_row)) pos++;
+    vi_insert_text(state, vi_offset(state, state->cursor_row, pos),
+                   state->yank_buf, yank_len);
+    state->cursor_col = pos + yank_len - 1;
   }
 }
 
@@ -926,62 +1194,372 @@ static void vi_paste_after(vi_state_t *state) {
 static void vi_paste_before(vi_state_t *state) {
   if (state->yank_buf[0] == '\0') return;
 
+  size_t yank_len = strlen(state->yank_buf);
   if (state->yank_is_line) {
-    vi_insert_line(state, state->cursor_row);
-    vi_line_set(&state->lines[state->cursor_row],
-                state->yank_buf, strlen(state->yank_buf));
+    size_t start = vi_buffer_line_start(state->buf, state->cursor_row);
+    vi_insert_text(state, start, state->yank_buf, yank_len);
+    vi_insert_text(state, start + yank_len, "\n", 1);
     state->cursor_col = 0;
   } else {
-    vi_line_t *line = &state->lines[state->cursor_row];
-    size_t pos = state->cursor_col;
-    for (size_t i = 0; state->yank_buf[i] != '\0'; i++) {
-      vi_line_insert_char(line, pos + i, state->yank_buf[i]);
-    }
+    vi_insert_text(state,
+                   vi_offset(state, state->cursor_row, state->cursor_col),
+                   state->yank_buf, yank_len);
+  }
+}
+
+
+/**
+ * Undoes or redoes changes and moves the cursor to the last one.
+ * @param state Pointer to state structure
+ * @param how 'u' to undo, 'r' to redo, '-' or '+' to go to the older or
+ *            newer text state
+ */
+static void vi_undo_move(vi_state_t *state, int how) {
+  size_t pos = vi_offset(state, state->cursor_row, state->cursor_col);
+  int rc;
+  switch (how) {
+    case 'u':
+      rc = vi_undo_undo(state->undo, state->buf, state->swap, &pos);
+      break;
+    case 'r':
+      rc = vi_undo_redo(state->undo, state->buf, state->swap, &pos);
+      break;
+    default:
+      rc = vi_undo_step(state->undo, how == '-' ? -1 : 1, state->buf,
+                        state->swap, &pos);
+      break;
+  }
+
+  if (rc == 0) {
+    snprintf(state->status_msg, sizeof(state->status_msg),
+             "Already at %s change",
+             how == 'u' || how == '-' ? "oldest" : "newest");
+    return;
+  }
+  if (rc == -1) {
+    snprintf(state->status_msg, sizeof(state->status_msg),
+             "Out of memory; undo history lost");
+  }
+
+  state->line_count = vi_buffer_line_count(state->buf);
+  state->modified = vi_undo_seq(state->undo) != state->saved_seq;
+  state->cursor_row = vi_buffer_line_of(state->buf, pos);
+  state->cursor_col = pos - vi_buffer_line_start(state->buf,
+                                                 state->cursor_row);
+  vi_clamp_cursor(state);
+}
+
+
+/**
+ * Makes a pattern the one n searches for.
+ * @param state Pointer to state structure
+ * @param pattern Pattern text
+ * @return 0 on success, -1 if the pattern is invalid
+ */
+static int vi_set_search(vi_state_t *state, const char *pattern) {
+  char err[200];
+  vi_pattern_t *pat = vi_pattern_new(pattern, 0, err, sizeof(err));
+  if (!pat) {
+    snprintf(state->status_msg, sizeof(state->status_msg),
+             "Invalid pattern: %s", err);
+    return -1;
   }
+  vi_pattern_free(state->search_pat);
+  state->search_pat = pat;
+  snprintf(state->search_str, sizeof(state->search_str), "%s", pattern);
+  return 0;
 }
 
 
 /**
- * Searches forward for the pattern in the command buffer.
+ * Moves the cursor to the next match of the last pattern searched for,
+ * going on from the top of the text after the bottom.
  * @param state Pointer to state structure
  */
 static void vi_search_forward(vi_state_t *state) {
-  if (state->command_buf[0] == '\0') return;
-
-  for (size_t row = state->cursor_row; row < state->line_count; row++) {
-    vi_line_t *line = &state->lines[row];
-    size_t start_col = (row == state->cursor_row) ? state->cursor_col + 1 : 0;
-
-    for (size_t col = start_col; col < line->len; col++) {
-      if (strncmp(&line->text[col], state->command_buf,
-                  strlen(state->command_buf)) == 0) {
-        state->cursor_row = row;
-        state->cursor_col = col;
-        snprintf(state->status_msg, sizeof(state->status_msg),
-                 "/%.200s", state->command_buf);
-        return;
-      }
+  if (!state->search_pat) {
+    snprintf(state->status_msg, sizeof(state->status_msg),
+             "No previous regular expression");
+    return;
+  }
+
+  size_t len;
+  size_t cursor = vi_offset(state, state->cursor_row, state->cursor_col);
+  const char *fmt = "/%.200s";
+  size_t hit = vi_pattern_find(state->search_pat, state->buf, cursor + 1,
+                               vi_buffer_size(state->buf), &len);
+  if (hit == (size_t)-1) {
+    fmt = "/%.200s (wrapped)";
+    hit = vi_pattern_find(state->search_pat, state->buf, 0, cursor + 1,
+                          &len);
+  }
+
+  if (hit == (size_t)-1) {
+    snprintf(state->status_msg, sizeof(state->status_msg),
+             "Pattern not found: %.200s", state->search_str);
+    return;
+  }
+
+  state->cursor_row = vi_buffer_line_of(state->buf, hit);
+  state->cursor_col = hit - vi_buffer_line_start(state->buf, state->cursor_row);
+  snprintf(state->status_msg, sizeof(state->status_msg), fmt,
+           state->search_str);
+}
+
+
+/**
+ * Reads a line address of an ex command: a line number, . or $.
+ * @param state Pointer to state structure
+ * @param p Pointer to the command text, moved past the address
+ * @return Line number, from 0, or (size_t)-1 if there is no address
+ */
+static size_t vi_parse_address(vi_state_t *state, const char **p) {
+  if (**p == '.') {
+    (*p)++;
+    return state->cursor_row;
+  }
+  if (**p == '$') {
+    (*p)++;
+    return state->line_count - 1;
+  }
+  if (isdigit((unsigned char)**p)) {
+    char *end;
+    unsigned long n = strtoul(*p, &end, 10);
+    *p = end;
+    return n > 0 ? (size_t)n - 1 : 0;
+  }
+  return (size_t)-1;
+}
+
+
+/**
+ * Copies one part of a s command up to its delimiter, which a backslash
+ * makes part of the text.
+ * @param p Pointer to the text, moved past the delimiter
+ * @param delim Delimiter
+ * @param out Where to copy the part
+ * @param size Size of out
+ */
+static void vi_parse_part(const char **p, char delim, char *out,
+                          size_t size) {
+  size_t n = 0;
+  const char *s = *p;
+  while (*s && *s != delim) {
+    /* An escaped delimiter is itself; other escapes are kept for later */
+    if (s[0] == '\\' && s[1] == delim) {
+      s++;
+    } else if (s[0] == '\\' && s[1] != '\0') {
+      if (n + 1 < size) out[n++] = *s;
+      s++;
+    }
+    if (n + 1 < size) out[n++] = *s;
+    s++;
+  }
+  out[n] = '\0';
+  *p = *s ? s + 1 : s;
+}
+
+
+/**
+ * Waits for a substitution's thread, showing how far it has got, until
+ * it is done or Ctrl-C stops it.
+ * @param state Pointer to state structure
+ * @param sub Substitution
+ */
+static void vi_subst_progress(vi_state_t *state, vi_subst_t *sub) {
+  size_t total = sub->to - sub->from;
+  int shown = -1;
+  while (!atomic_load(&sub->done)) {
+    vi_input_wait(100);
+    const char *intr = memchr(input_buf + input_pos, 0x03,
+                              input_len - input_pos);
+    if (intr || term_terminated) {
+      atomic_store(&sub->cancel, 1);
+      if (intr) input_pos = (size_t)(intr - input_buf) + 1;
+    }
+
+    size_t done = atomic_load(&sub->scanned);
+    int percent = total ? (int)((double)done * 100 / (double)total) : 100;
+    if (percent != shown && !atomic_load(&sub->done)) {
+      snprintf(state->status_msg, sizeof(state->status_msg),
+               "Substituting... %d%% (Ctrl-C to stop)", percent);
+      vi_draw_screen(state);
+      shown = percent;
+    }
+  }
+  state->status_msg[0] = '\0';
+}
+
+
+/**
+ * Makes the replacements a substitution found, as one edit that undoes
+ * as one step, and moves to the last line changed.
+ * @param state Pointer to state structure
+ * @param sub Substitution, with at least one replacement
+ */
+static void vi_subst_apply(vi_state_t *state, vi_subst_t *sub) {
+  const vi_replace_t *last = &sub->reps[sub->count - 1];
+  size_t from = sub->reps[0].pos;
+  size_t to = last->pos + last->len;
+  vi_cut_t *cut;
+  if (vi_buffer_replace(state->buf, from, to, sub->reps, sub->count,
+                        sub->text, &cut) == -1) {
+    snprintf(state->status_msg, sizeof(state->status_msg), "Out of memory");
+    return;
+  }
+
+  /* The journal gets each replacement, which costs as much as they do
+   * rather than the size of the range */
+  size_t added = 0;
+  size_t removed = 0;
+  size_t at = from;
+  for (size_t i = 0; i < sub->count; i++) {
+    const vi_replace_t *rep = &sub->reps[i];
+    at = rep->pos + added - removed;
+    if (rep->len > 0) vi_swap_delete(state->swap, at, rep->len);
+    if (rep->text_len > 0) {
+      vi_swap_insert(state->swap, at, sub->text + rep->text_off,
+                     rep->text_len);
     }
+    added += rep->text_len;
+    removed += rep->len;
   }
 
-  for (size_t row = 0; row <= state->cursor_row; row++) {
-    vi_line_t *line = &state->lines[row];
-    size_t end_col = (row == state->cursor_row) ? state->cursor_col : line->len;
+  vi_undo_boundary(state->undo);
+  if (vi_undo_delete(state->undo, from, cut) == -1 ||
+      vi_undo_insert(state->undo, from, to - from + added - removed) == -1) {
+    snprintf(state->status_msg, sizeof(state->status_msg),
+             "Out of memory; undo history lost");
+  }
+  vi_undo_boundary(state->undo);
+
+  state->line_count = vi_buffer_line_count(state->buf);
+  state->modified = 1;
+  state->cursor_row = vi_buffer_line_of(state->buf, at);
+  state->cursor_col = 0;
+  vi_clamp_cursor(state);
+}
+
 
-    for (size_t col = 0; col < end_col; col++) {
-      if (strncmp(&line->text[col], state->command_buf,
-                  strlen(state->command_buf)) == 0) {
-        state->cursor_row = row;
-        state->cursor_col = col;
-        snprintf(state->status_msg, sizeof(state->status_msg),
-                 "/%.200s (wrapped)", state->command_buf);
-        return;
+/**
+ * Runs a :s command, [range]s/pattern/replacement/[flags], where range
+ * is % or one or two line addresses and flags are g for every match in
+ * a line and i to ignore case. An empty pattern is the last one
+ * searched for. The matches are found on another thread, so that a
+ * large file shows progress and Ctrl-C can stop it.
+ * @param state Pointer to state structure
+ * @param cmd Command text
+ * @return 0 if it was a :s command, -1 if not
+ */
+static int vi_substitute(vi_state_t *state, const char *cmd) {
+  const char *p = cmd;
+  size_t first = state->cursor_row;
+  size_t last = state->cursor_row;
+  if (*p == '%') {
+    first = 0;
+    last = state->line_count - 1;
+    p++;
+  } else {
+    size_t addr = vi_parse_address(state, &p);
+    if (addr != (size_t)-1) {
+      first = last = addr;
+      if (*p == ',') {
+        p++;
+        last = vi_parse_address(state, &p);
+        if (last == (size_t)-1) return -1;
       }
     }
   }
 
-  snprintf(state->status_msg, sizeof(state->status_msg),
-           "Pattern not found: %.200s", state->command_buf);
+  char delim = p[0] == 's' ? p[1] : '\0';
+  if (delim == '\0' || isalnum((unsigned char)delim) || delim == '\\' ||
+      delim == ' ') {
+    return -1;
+  }
+  p += 2;
+
+  char pattern[256];
+  char repl[256];
+  vi_parse_part(&p, delim, pattern, sizeof(pattern));
+  vi_parse_part(&p, delim, repl, sizeof(repl));
+  int global = 0;
+  int icase = 0;
+  for (; *p; p++) {
+    if (*p == 'g') {
+      global = 1;
+    } else if (*p == 'i') {
+      icase = 1;
+    } else {
+      snprintf(state->status_msg, sizeof(state->status_msg),
+               "Trailing characters: %.200s", p);
+      return 0;
+    }
+  }
+
+  if (pattern[0] == '\0') {
+    if (state->search_str[0] == '\0') {
+      snprintf(state->status_msg, sizeof(state->status_msg),
+               "No previous regular expression");
+      return 0;
+    }
+    snprintf(pattern, sizeof(pattern), "%s", state->search_str);
+  }
+  if (last < first) {
+    size_t t = first;
+    first = last;
+    last = t;
+  }
+  if (last >= state->line_count) last = state->line_count - 1;
+  if (first > last) first = last;
+
+  char err[200];
+  vi_pattern_t *pat = vi_pattern_new(pattern, icase, err, sizeof(err));
+  if (!pat) {
+    snprintf(state->status_msg, sizeof(state->status_msg),
+             "Invalid pattern: %s", err);
+    return 0;
+  }
+
+  vi_subst_t sub = {
+    .pat = pat,
+    .buf = state->buf,
+    .from = vi_buffer_line_start(state->buf, first),
+    .to = vi_buffer_line_start(state->buf, last) +
+          vi_buffer_line_length(state->buf, last),
+    .repl = repl,
+    .global = global
+  };
+  if (vi_subst_start(&sub) == -1) {
+    snprintf(state->status_msg, sizeof(state->status_msg),
+             "Cannot start substitution");
+    vi_pattern_free(pat);
+    return 0;
+  }
+  vi_subst_progress(state, &sub);
+  vi_subst_wait(&sub);
+
+  if (sub.error) {
+    snprintf(state->status_msg, sizeof(state->status_msg), "%s",
+             atomic_load(&sub.cancel) ? "Interrupted" : "Out of memory");
+  } else if (sub.count == 0) {
+    snprintf(state->status_msg, sizeof(state->status_msg),
+             "Pattern not found: %.200s", pattern);
+  } else {
+    vi_subst_apply(state, &sub);
+    if (state->status_msg[0] == '\0') {
+      snprintf(state->status_msg, sizeof(state->status_msg),
+               "%zu substitution%s on %zu line%s", sub.count,
+               sub.count == 1 ? "" : "s", sub.lines,
+               sub.lines == 1 ? "" : "s");
+    }
+  }
+  vi_subst_free(&sub);
+
+  /* n goes on to search for the pattern */
+  vi_pattern_free(state->search_pat);
+  state->search_pat = pat;
+  snprintf(state->search_str, sizeof(state->search_str), "%s", pattern);
+  return 0;
 }
 
 
@@ -1019,6 +1597,9 @@ static int vi_process_command(vi_state_t *state) {
   }
 
   if (strncmp(cmd, "w ", 2) == 0) {
+    /* The journal belongs to the old name */
+    vi_swap_close(state->swap, 0);
+    state->swap = NULL;
     free(state->filename);
     state->filename = strdup(cmd + 2);
     vi_save_file(state);
@@ -1033,6 +1614,10 @@ static int vi_process_command(vi_state_t *state) {
     return 0;
   }
 
+  if (vi_substitute(state, cmd) == 0) {
+    return 0;
+  }
+
   snprintf(state->status_msg, sizeof(state->status_msg),
            "Not an editor command: %.200s", cmd);
   return 0;
@@ -1057,7 +1642,8 @@ static int vi_handle_normal_mode(vi_state_t *state, int key) {
     if (key == 'g') {
       state->cursor_row = 0;
       state->cursor_col = 0;
-      return 0;
+    } else if (key == '-' || key == '+') {
+      vi_undo_move(state, key);
     }
     return 0;
   }
@@ -1103,7 +1689,7 @@ static int vi_handle_normal_mode(vi_state_t *state, int key) {
 
     case 'l':
     case KEY_ARROW_RIGHT:
-      if (state->cursor_col < state->lines[state->cursor_row].len - 1) {
+      if (state->cursor_col + 1 < vi_line_len(state, state->cursor_row)) {
         state->cursor_col++;
       }
       break;
@@ -1114,11 +1700,11 @@ static int vi_handle_normal_mode(vi_state_t *state, int key) {
       break;
 
     case '$':
-    case KEY_END:
-      if (state->lines[state->cursor_row].len > 0) {
-        state->cursor_col = state->lines[state->cursor_row].len - 1;
-      }
+    case KEY_END: {
+      size_t len = vi_line_len(state, state->cursor_row);
+      if (len > 0) state->cursor_col = len - 1;
       break;
+    }
 
     case 'g':
       pending_g = 1;
@@ -1145,14 +1731,14 @@ static int vi_handle_normal_mode(vi_state_t *state, int key) {
 
     case 'a':
       state->mode = MODE_INSERT;
-      if (state->lines[state->cursor_row].len > 0) {
+      if (vi_line_len(state, state->cursor_row) > 0) {
         state->cursor_col++;
       }
       break;
 
     case 'A':
       state->mode = MODE_INSERT;
-      state->cursor_col = state->lines[state->cursor_row].len;
+      state->cursor_col = vi_line_len(state, state->cursor_row);
       break;
 
     case 'o':
@@ -1170,10 +1756,10 @@ static int vi_handle_normal_mode(vi_state_t *state, int key) {
 
     case 'x':
     case KEY_DEL:
-      if (state->lines[state->cursor_row].len > 0) {
-        vi_line_delete_char(&state->lines[state->cursor_row],
-                            state->cursor_col);
-        state->modified = 1;
+      if (state->cursor_col < vi_line_len(state, state->cursor_row)) {
+        vi_delete_text(state,
+                       vi_offset(state, state->cursor_row, state->cursor_col),
+                       1);
         vi_clamp_cursor(state);
       }
       break;
@@ -1196,6 +1782,14 @@ static int vi_handle_normal_mode(vi_state_t *state, int key) {
       vi_clamp_cursor(state);
       break;
 
+    case 'u':
+      vi_undo_move(state, 'u');
+      break;
+
+    case 0x12:  /* Ctrl-R */
+      vi_undo_move(state, 'r');
+      break;
+
     case ':':
       state->mode = MODE_COMMAND;
       state->command_buf[0] = '\0';
@@ -1243,7 +1837,7 @@ static int vi_handle_normal_mode(vi_state_t *state, int key) {
  * @return 1 to quit, 0 to continue
  */
 static int vi_handle_insert_mode(vi_state_t *state, int key) {
-  vi_line_t *line = &state->lines[state->cursor_row];
+  size_t pos = vi_offset(state, state->cursor_row, state->cursor_col);
 
   switch (key) {
     case '\x1b':
@@ -1253,34 +1847,21 @@ static int vi_handle_insert_mode(vi_state_t *state, int key) {
       break;
 
     case '\r':
-    case '\n': {
-      char *rest = line->text + state->cursor_col;
-      size_t rest_len = line->len - state->cursor_col;
-
-      vi_insert_line(state, state->cursor_row + 1);
-      vi_line_set(&state->lines[state->cursor_row + 1], rest, rest_len);
-
-      line->text[state->cursor_col] = '\0';
-      line->len = state->cursor_col;
-
+    case '\n':
+      vi_insert_text(state, pos, "\n", 1);
       state->cursor_row++;
       state->cursor_col = 0;
       break;
-    }
 
     case 127:
     case '\x08':
       if (state->cursor_col > 0) {
-        vi_line_delete_char(line, state->cursor_col - 1);
+        vi_delete_text(state, pos - 1, 1);
         state->cursor_col--;
-        state->modified = 1;
       } else if (state->cursor_row > 0) {
-        size_t prev_len = state->lines[state->cursor_row - 1].len;
-        vi_line_ensure_capacity(&state->lines[state->cursor_row - 1],
-                                prev_len + line->len);
-        strcat(state->lines[state->cursor_row - 1].text, line->text);
-        state->lines[state->cursor_row - 1].len += line->len;
-        vi_delete_line(state, state->cursor_row);
+        /* Join with the previous line by deleting the newline between */
+        size_t prev_len = vi_line_len(state, state->cursor_row - 1);
+        vi_delete_text(state, pos - 1, 1);
         state->cursor_row--;
         state->cursor_col = prev_len;
       }
@@ -1291,7 +1872,9 @@ static int vi_handle_insert_mode(vi_state_t *state, int key) {
       break;
 
     case KEY_ARROW_RIGHT:
-      if (state->cursor_col < line->len) state->cursor_col++;
+      if (state->cursor_col < vi_line_len(state, state->cursor_row)) {
+        state->cursor_col++;
+      }
       break;
 
     case KEY_ARROW_UP:
@@ -1306,9 +1889,13 @@ static int vi_handle_insert_mode(vi_state_t *state, int key) {
 
     default:
       if (key >= 32 && key < 127) {
-        vi_line_insert_char(line, state->cursor_col, (char)key);
-        state->cursor_col++;
-        state->modified = 1;
+        /* Characters already read behind this one go in with it */
+        char text[256];
+        size_t len = 1;
+        text[0] = (char)key;
+        len += vi_input_take_text(text + 1, sizeof(text) - 1);
+        vi_insert_text(state, pos, text, len);
+        state->cursor_col += len;
       }
       break;
   }
@@ -1317,6 +1904,52 @@ static int vi_handle_insert_mode(vi_state_t *state, int key) {
 }
 
 
+/**
+ * Inserts text the terminal marked as pasted, as one edit at the cursor,
+ * leaving the cursor after it. Keys in the text are not interpreted,
+ * so pasting in normal mode does not run commands. At a : or / prompt
+ * the text's first line is added to the prompt.
+ * @param state Pointer to state structure
+ */
+static void vi_paste(vi_state_t *state) {
+  char *text;
+  size_t len;
+  if (vi_read_paste(&text, &len) == -1) {
+    snprintf(state->status_msg, sizeof(state->status_msg),
+             "Paste too large: out of memory");
+    return;
+  }
+  if (!text) return;
+
+  if (state->mode == MODE_COMMAND || state->mode == MODE_SEARCH) {
+    for (size_t i = 0; i < len && text[i] != '\n'; i++) {
+      if (text[i] >= 32 && text[i] < 127 &&
+          state->command_len < sizeof(state->command_buf) - 1) {
+        state->command_buf[state->command_len++] = text[i];
+      }
+    }
+    state->command_buf[state->command_len] = '\0';
+    free(text);
+    return;
+  }
+
+  size_t pos = vi_offset(state, state->cursor_row, state->cursor_col);
+  vi_insert_text(state, pos, text, len);
+
+  size_t line_start = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (text[i] == '\n') {
+      state->cursor_row++;
+      line_start = i + 1;
+    }
+  }
+  if (line_start > 0) state->cursor_col = 0;
+  state->cursor_col += len - line_start;
+  vi_clamp_cursor(state);
+  free(text);
+}
+
+
 /**
  * Handles a key press in command mode.
  * @param state Pointer to state structure
@@ -1383,7 +2016,8 @@ static int vi_handle_search_mode(vi_state_t *state, int key) {
     case '\r':
     case '\n':
       state->mode = MODE_NORMAL;
-      if (state->command_len > 0) {
+      if (state->command_len > 0 &&
+          vi_set_search(state, state->command_buf) == 0) {
         vi_search_forward(state);
         vi_clamp_cursor(state);
         vi_scroll_to_cursor(state);
@@ -1445,15 +2079,48 @@ static int vi_run(int argc, char **argv) {
   }
 
   vi_state_t state;
-  vi_state_init(&state);
+  if (vi_state_init(&state) == -1) {
+    fprintf(stderr, "vi: out of memory\n");
+    vi_state_free(&state);
+    cleanup_vi_argtable(&args);
+    return 1;
+  }
+
+  if (args.recover->count > 0 && args.file->count == 0) {
+    fprintf(stderr, "vi: -r needs a FILE\n");
+    vi_state_free(&state);
+    cleanup_vi_argtable(&args);
+    return 1;
+  }
 
   if (args.file->count > 0) {
-    if (vi_load_file(&state, args.file->filename[0]) == -1) {
-      fprintf(stderr, "vi: %s: %s\n", args.file->filename[0], strerror(errno));
+    const char *path = args.file->filename[0];
+    if (vi_load_file(&state, path) == -1) {
+      fprintf(stderr, "vi: %s: %s\n", path, strerror(errno));
       vi_state_free(&state);
       cleanup_vi_argtable(&args);
       return 1;
     }
+
+    if (args.recover->count > 0) {
+      long edits = vi_swap_recover(path, state.buf);
+      if (edits == -1) {
+        fprintf(stderr, "vi: %s.swp: %s\n", path,
+                errno == ESTALE ? "file changed since the swap file was "
+                                  "written"
+                                : strerror(errno));
+        vi_state_free(&state);
+        cleanup_vi_argtable(&args);
+        return 1;
+      }
+      state.line_count = vi_buffer_line_count(state.buf);
+      state.modified = edits > 0;
+      /* Undo starts from the recovered text, which is not what is on disk */
+      if (state.modified) state.saved_seq = 0;
+      vi_swap_start(&state, 1);
+      snprintf(state.status_msg, sizeof(state.status_msg),
+               "Recovered %ld changes from %.200s.swp", edits, path);
+    }
   }
 
   if (enable_raw_mode() == -1) {
@@ -1480,7 +2147,13 @@ static int vi_run(int argc, char **argv) {
   sa.sa_handler = handle_sigterm;
   sigaction(SIGTERM, &sa, NULL);
 
-  clear_screen();
+  state.screen = jbox_screen_new(STDOUT_FILENO, state.rows, state.cols);
+  if (!state.screen) {
+    fprintf(stderr, "vi: out of memory\n");
+    vi_state_free(&state);
+    cleanup_vi_argtable(&args);
+    return 1;
+  }
   vi_draw_screen(&state);
 
   int quit = 0;
@@ -1488,7 +2161,14 @@ static int vi_run(int argc, char **argv) {
     /* Handle terminal resize */
     if (term_resized) {
       term_resized = 0;
-      get_terminal_size(&state.rows, &state.cols);
+      int rows, cols;
+      get_terminal_size(&rows, &cols);
+      if (jbox_screen_resize(state.screen, rows, cols) == 0) {
+        state.rows = rows;
+        state.cols = cols;
+      } else {
+        jbox_screen_invalidate(state.screen);
+      }
       vi_scroll_to_cursor(&state);
       vi_draw_screen(&state);
     }
@@ -1511,6 +2191,11 @@ static int vi_run(int argc, char **argv) {
     int key = vi_read_key();
     if (key == -1) continue;
     if (key == -2) continue;
+    if (key == -3) {
+      /* Idle: autosave the edits made since the last flush */
+      vi_swap_flush(state.swap);
+      continue;
+    }
 
     /* Handle Ctrl+C (0x03) - cancel current operation, return to normal mode */
     if (key == 0x03) {
@@ -1529,28 +2214,36 @@ static int vi_run(int argc, char **argv) {
       continue;
     }
 
-    switch (state.mode) {
-      case MODE_NORMAL:
-        quit = vi_handle_normal_mode(&state, key);
-        break;
-      case MODE_INSERT:
-        quit = vi_handle_insert_mode(&state, key);
-        break;
-      case MODE_COMMAND:
-        quit = vi_handle_command_mode(&state, key);
-        break;
-      case MODE_SEARCH:
-        quit = vi_handle_search_mode(&state, key);
-        break;
+    /* Each normal mode command, with any text it inserts, undoes as one */
+    if (state.mode == MODE_NORMAL) vi_undo_boundary(state.undo);
+
+    if (key == KEY_PASTE) {
+      vi_paste(&state);
+    } else {
+      switch (state.mode) {
+        case MODE_NORMAL:
+          quit = vi_handle_normal_mode(&state, key);
+          break;
+        case MODE_INSERT:
+          quit = vi_handle_insert_mode(&state, key);
+          break;
+        case MODE_COMMAND:
+          quit = vi_handle_command_mode(&state, key);
+          break;
+        case MODE_SEARCH:
+          quit = vi_handle_search_mode(&state, key);
+          break;
+      }
     }
 
     vi_scroll_to_cursor(&state);
-    vi_draw_screen(&state);
+    /* Keys already waiting are handled first, and drawn once */
+    if (!vi_input_pending()) vi_draw_screen(&state);
   }
 
-  clear_screen();
-  move_cursor(1, 1);
-  show_cursor();
+  jbox_screen_clear(state.screen);
+  jbox_screen_set_cursor(state.screen, 0, 0);
+  jbox_screen_flush(state.screen);
 
   vi_state_free(&state);
   cleanup_vi_argtable(&args);
@@ -1569,7 +2262,8 @@ const jshell_cmd_spec_t cmd_vi_spec = {
                "and commands with :w, :q, :wq.",
   .type = CMD_EXTERNAL,
   .run = vi_run,
-  .print_usage = vi_print_usage
+  .print_usage = vi_print_usage,
+  .describe_args = vi_describe_args
 };
 
 
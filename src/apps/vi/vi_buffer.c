@@ -0,0 +1,908 @@
+/** @file vi_buffer.c
+ *  @brief Piece table holding the text edited by vi
+ *
+ * The pieces form a treap ordered by position in the text. Every node
+ * caches the length and newline count of its subtree, so an offset or a
+ * line number is found by one descent from the root, and an edit is a
+ * split of the tree at the edit position followed by a merge.
+ *
+ * A loaded file is cut into pieces of about VI_CHUNK_SIZE bytes ending
+ * at line ends, so the first edit in a line only has to count newlines
+ * in one small piece, and most lines can be handed out in place.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utils/jbox_linereader.h"
+#include "vi_buffer.h"
+
+
+/** Loaded text is cut into pieces of at least this size, at line ends */
+#define VI_CHUNK_SIZE 8192
+
+/** Text left alone between replacements is copied if shorter than this */
+#define VI_REPLACE_COPY 1024
+
+/** Where the bytes of a piece live */
+typedef enum {
+  PIECE_FILE,                 /* The mapped file */
+  PIECE_ADD                   /* The append buffer */
+} vi_piece_src_t;
+
+/** One piece of the text, and the treap node holding it */
+typedef struct vi_piece {
+  struct vi_piece *left;
+  struct vi_piece *right;
+  uint64_t prio;              /* Heap order: above both children */
+  vi_piece_src_t src;
+  size_t off;                 /* Start within the source */
+  size_t len;
+  size_t lf;                  /* Newlines in the piece */
+  size_t sub_len;             /* Bytes in the subtree */
+  size_t sub_lf;              /* Newlines in the subtree */
+} vi_piece_t;
+
+/** Pieces in text order, gathered to build a tree of them */
+typedef struct {
+  vi_piece_t **items;
+  size_t count;
+  size_t cap;
+} vi_piece_list_t;
+
+struct vi_buffer {
+  vi_piece_t *root;
+  char *map;                  /* The mapped file, or NULL */
+  size_t map_size;
+  char *add;                  /* Append-only buffer */
+  size_t add_len;
+  size_t add_cap;
+  char *scratch;              /* Lines that span pieces */
+  size_t scratch_cap;
+  uint64_t seed;              /* xorshift state for priorities */
+};
+
+
+/**
+ * Returns the next pseudo-random priority.
+ */
+static uint64_t next_prio(vi_buffer_t *buf) {
+  uint64_t x = buf->seed;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  buf->seed = x;
+  return x;
+}
+
+
+static size_t sub_len(const vi_piece_t *p) {
+  return p ? p->sub_len : 0;
+}
+
+
+static size_t sub_lf(const vi_piece_t *p) {
+  return p ? p->sub_lf : 0;
+}
+
+
+/**
+ * Recomputes the subtree totals of a node from its children.
+ */
+static void update(vi_piece_t *p) {
+  p->sub_len = p->len + sub_len(p->left) + sub_len(p->right);
+  p->sub_lf = p->lf + sub_lf(p->left) + sub_lf(p->right);
+}
+
+
+/**
+ * Returns the bytes of a piece.
+ */
+static const char *piece_data(const vi_buffer_t *buf, const vi_piece_t *p) {
+  return (p->src == PIECE_FILE ? buf->map : buf->add) + p->off;
+}
+
+
+static void free_tree(vi_piece_t *p) {
+  if (!p) return;
+  free_tree(p->left);
+  free_tree(p->right);
+  free(p);
+}
+
+
+/**
+ * Joins two trees, all of whose text in a comes before b.
+ */
+static vi_piece_t *merge(vi_piece_t *a, vi_piece_t *b) {
+  if (!a) return b;
+  if (!b) return a;
+  if (a->prio > b->prio) {
+    a->right = merge(a->right, b);
+    update(a);
+    return a;
+  }
+  b->left = merge(a, b->left);
+  update(b);
+  return b;
+}
+
+
+/**
+ * Splits a tree into the text before pos and the text from pos on. A
+ * piece straddling pos is cut in two, the second half taking *spare,
+ * which is then set to NULL.
+ */
+static void split(vi_buffer_t *buf, vi_piece_t *t, size_t pos,
+                  vi_piece_t **l, vi_piece_t **r, vi_piece_t **spare) {
+  if (!t) {
+    *l = *r = NULL;
+    return;
+  }
+
+  size_t left_len = sub_len(t->left);
+  if (pos <= left_len) {
+    split(buf, t->left, pos, l, &t->left, spare);
+    update(t);
+    *r = t;
+  } else if (pos >= left_len + t->len) {
+    split(buf, t->right, pos - left_len - t->len, &t->right, r, spare);
+    update(t);
+    *l = t;
+  } else {
+    size_t k = pos - left_len;
+    size_t k_lf = jbox_linereader_count(piece_data(buf, t), k);
+    vi_piece_t *tail = *spare;
+    *spare = NULL;
+    tail->left = tail->right = NULL;
+    tail->prio = next_prio(buf);
+    tail->src = t->src;
+    tail->off = t->off + k;
+    tail->len = t->len - k;
+    tail->lf = t->lf - k_lf;
+    update(tail);
+    t->len = k;
+    t->lf = k_lf;
+    *r = merge(tail, t->right);
+    t->right = NULL;
+    update(t);
+    *l = t;
+  }
+}
+
+
+/**
+ * Grows the piece ending at pos by n bytes if it is the piece that ends
+ * at the end of the append buffer, which the n bytes were just appended
+ * to. Updates the totals on the way back up.
+ * @return 1 if the piece was grown, 0 if the text needs a new piece
+ */
+static int extend(vi_piece_t *t, size_t pos, size_t add_end, size_t n,
+                  size_t lf) {
+  if (!t) return 0;
+
+  size_t left_len = sub_len(t->left);
+  int grown;
+  if (pos <= left_len) {
+    grown = extend(t->left, pos, add_end, n, lf);
+  } else if (pos == left_len + t->len) {
+    grown = t->src == PIECE_ADD && t->off + t->len == add_end;
+    if (grown) {
+      t->len += n;
+      t->lf += lf;
+    }
+  } else if (pos > left_len + t->len) {
+    grown = extend(t->right, pos - left_len - t->len, add_end, n, lf);
+  } else {
+    grown = 0;
+  }
+  if (grown) {
+    t->sub_len += n;
+    t->sub_lf += lf;
+  }
+  return grown;
+}
+
+
+/**
+ * Finds the piece holding the byte at pos, which must be in the text.
+ * @param off Set to the offset of pos within the piece
+ */
+static const vi_piece_t *locate(const vi_piece_t *t, size_t pos,
+                                size_t *off) {
+  while (t) {
+    size_t left_len = sub_len(t->left);
+    if (pos < left_len) {
+      t = t->left;
+    } else if (pos < left_len + t->len) {
+      *off = pos - left_len;
+      return t;
+    } else {
+      pos -= left_len + t->len;
+      t = t->right;
+    }
+  }
+  return NULL;
+}
+
+
+/**
+ * Copies up to len bytes from pos of a subtree.
+ * @return Number of bytes copied
+ */
+static size_t read_tree(const vi_buffer_t *buf, const vi_piece_t *t,
+                        size_t pos, char *dst, size_t len) {
+  if (!t || len == 0 || pos >= t->sub_len) return 0;
+
+  size_t left_len = sub_len(t->left);
+  size_t copied = 0;
+  if (pos < left_len) {
+    copied = read_tree(buf, t->left, pos, dst, len);
+  }
+  size_t at = pos + copied;
+  if (copied < len && at >= left_len && at < left_len + t->len) {
+    size_t k = at - left_len;
+    size_t n = t->len - k;
+    if (n > len - copied) n = len - copied;
+    memcpy(dst + copied, piece_data(buf, t) + k, n);
+    copied += n;
+  }
+  at = pos + copied;
+  if (copied < len && at >= left_len + t->len) {
+    copied += read_tree(buf, t->right, at - left_len - t->len, dst + copied,
+                        len - copied);
+  }
+  return copied;
+}
+
+
+/**
+ * Describes up to max spans of a subtree from pos on.
+ * @param count Number of entries filled so far, updated
+ * @return Number of bytes described
+ */
+static size_t spans_tree(const vi_buffer_t *buf, const vi_piece_t *t,
+                         size_t pos, struct iovec *iov, size_t max,
+                         size_t *count) {
+  if (!t || *count == max || pos >= t->sub_len) return 0;
+
+  size_t left_len = sub_len(t->left);
+  size_t done = 0;
+  if (pos < left_len) {
+    done = spans_tree(buf, t->left, pos, iov, max, count);
+  }
+  size_t at = pos + done;
+  if (*count < max && at >= left_len && at < left_len + t->len) {
+    size_t k = at - left_len;
+    iov[*count].iov_base = (void *)(piece_data(buf, t) + k);
+    iov[*count].iov_len = t->len - k;
+    (*count)++;
+    done += t->len - k;
+  }
+  at = pos + done;
+  if (*count < max && at >= left_len + t->len) {
+    done += spans_tree(buf, t->right, at - left_len - t->len, iov, max,
+                       count);
+  }
+  return done;
+}
+
+
+/**
+ * Builds a balanced tree from pieces in text order. Priorities are drawn
+ * from a band that shrinks with depth, which keeps the heap order that
+ * later random priorities rely on.
+ */
+static vi_piece_t *build(vi_buffer_t *buf, vi_piece_t **pieces, size_t n,
+                         int depth) {
+  if (n == 0) return NULL;
+  size_t mid = n / 2;
+  vi_piece_t *p = pieces[mid];
+  uint64_t hi = UINT64_MAX >> depth;
+  uint64_t band = hi - (UINT64_MAX >> (depth + 1));
+  p->prio = hi - (band ? next_prio(buf) % band : 0);
+  p->left = build(buf, pieces, mid, depth + 1);
+  p->right = build(buf, pieces + mid + 1, n - mid - 1, depth + 1);
+  update(p);
+  return p;
+}
+
+
+/**
+ * Appends a piece to a list.
+ * @return 0 on success, -1 if out of memory
+ */
+static int list_push(vi_piece_list_t *list, vi_piece_t *p) {
+  if (list->count == list->cap) {
+    size_t cap = list->cap ? list->cap * 2 : 64;
+    vi_piece_t **items = realloc(list->items, cap * sizeof(*items));
+    if (!items) return -1;
+    list->items = items;
+    list->cap = cap;
+  }
+  list->items[list->count++] = p;
+  return 0;
+}
+
+
+/**
+ * Appends a new piece to a list, or grows the last piece if the new one
+ * continues it and the two still make a small piece.
+ * @return 0 on success, -1 if out of memory
+ */
+static int list_add(vi_piece_list_t *list, vi_piece_src_t src, size_t off,
+                    size_t len, size_t lf) {
+  if (list->count > 0) {
+    vi_piece_t *last = list->items[list->count - 1];
+    if (last->src == src && last->off + last->len == off &&
+        last->len + len <= VI_CHUNK_SIZE) {
+      last->len += len;
+      last->lf += lf;
+      return 0;
+    }
+  }
+
+  vi_piece_t *p = malloc(sizeof(*p));
+  if (!p) return -1;
+  p->src = src;
+  p->off = off;
+  p->len = len;
+  p->lf = lf;
+  if (list_push(list, p) == -1) {
+    free(p);
+    return -1;
+  }
+  return 0;
+}
+
+
+/**
+ * Frees a list and the pieces in it.
+ */
+static void list_free(vi_piece_list_t *list) {
+  for (size_t i = 0; i < list->count; i++) free(list->items[i]);
+  free(list->items);
+}
+
+
+/**
+ * Appends the pieces of a tree to a list, in text order.
+ * @return 0 on success, -1 if out of memory
+ */
+static int list_tree(vi_piece_list_t *list, vi_piece_t *t) {
+  if (!t) return 0;
+  if (list_tree(list, t->left) == -1 || list_push(list, t) == -1) return -1;
+  return list_tree(list, t->right);
+}
+
+
+/**
+ * Cuts base[off, off + len) of a source into pieces of about
+ * VI_CHUNK_SIZE ending at line ends, appended to a list.
+ * @return 0 on success, -1 if out of memory
+ */
+static int list_add_chunks(vi_piece_list_t *list, vi_piece_src_t src,
+                           const char *base, size_t off, size_t len) {
+  const char *text = base + off;
+  size_t start = 0;
+  while (start < len) {
+    size_t end = len;
+    if (len - start > VI_CHUNK_SIZE) {
+      const char *nl = memchr(text + start + VI_CHUNK_SIZE - 1, '\n',
+                              len - start - VI_CHUNK_SIZE + 1);
+      if (nl) end = (size_t)(nl - text) + 1;
+    }
+    size_t lf = jbox_linereader_count(text + start, end - start);
+    if (list_add(list, src, off + start, end - start, lf) == -1) return -1;
+    start = end;
+  }
+  return 0;
+}
+
+
+/**
+ * Cuts text[0, len) into pieces of the given source and builds a tree
+ * of them.
+ * @return 0 on success, -1 if out of memory
+ */
+static int build_pieces(vi_buffer_t *buf, const char *text, size_t len,
+                        vi_piece_src_t src, vi_piece_t **root) {
+  vi_piece_list_t list = { 0 };
+  if (list_add_chunks(&list, src, text, 0, len) == -1) {
+    list_free(&list);
+    return -1;
+  }
+  *root = build(buf, list.items, list.count, 0);
+  free(list.items);
+  return 0;
+}
+
+
+/**
+ * Makes room for n more bytes in the append buffer.
+ * @return 0 on success, -1 if out of memory
+ */
+static int reserve_add(vi_buffer_t *buf, size_t n) {
+  if (buf->add_len + n <= buf->add_cap) return 0;
+  size_t cap = buf->add_cap ? buf->add_cap : 65536;
+  while (cap < buf->add_len + n) cap *= 2;
+  char *add = realloc(buf->add, cap);
+  if (!add) return -1;
+  buf->add = add;
+  buf->add_cap = cap;
+  return 0;
+}
+
+
+/**
+ * Reads all of fd into a new malloc'd buffer.
+ * @return 0 on success, -1 on error (errno set)
+ */
+static int read_all(int fd, char **data, size_t *len, size_t *cap) {
+  size_t size = 0;
+  size_t alloc = 65536;
+  char *p = malloc(alloc);
+  if (!p) return -1;
+
+  for (;;) {
+    if (size == alloc) {
+      char *grown = realloc(p, alloc * 2);
+      if (!grown) {
+        free(p);
+        errno = ENOMEM;
+        return -1;
+      }
+      p = grown;
+      alloc *= 2;
+    }
+    ssize_t n = read(fd, p + size, alloc - size);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      free(p);
+      return -1;
+    }
+    if (n == 0) break;
+    size += (size_t)n;
+  }
+
+  *data = p;
+  *len = size;
+  *cap = alloc;
+  return 0;
+}
+
+
+vi_buffer_t *vi_buffer_new(void) {
+  vi_buffer_t *buf = calloc(1, sizeof(*buf));
+  if (!buf) return NULL;
+  buf->seed = 0x9e3779b97f4a7c15ULL ^ (uint64_t)(uintptr_t)buf;
+  return buf;
+}
+
+
+void vi_buffer_free(vi_buffer_t *buf) {
+  if (!buf) return;
+  free_tree(buf->root);
+  if (buf->map) munmap(buf->map, buf->map_size);
+  free(buf->add);
+  free(buf->scratch);
+  free(buf);
+}
+
+
+int vi_buffer_load(vi_buffer_t *buf, const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) return -1;
+
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return -1;
+  }
+  if (S_ISDIR(st.st_mode)) {
+    close(fd);
+    errno = EISDIR;
+    return -1;
+  }
+
+  char *map = NULL;
+  size_t map_size = 0;
+  char *add = NULL;
+  size_t add_len = 0;
+  size_t add_cap = 0;
+  const char *text = NULL;
+  size_t len = 0;
+  vi_piece_src_t src = PIECE_FILE;
+
+  if (S_ISREG(st.st_mode)) {
+    if (st.st_size > 0) {
+      map_size = (size_t)st.st_size;
+      map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map == MAP_FAILED) {
+        close(fd);
+        return -1;
+      }
+      text = map;
+      len = map_size;
+    }
+  } else {
+    if (read_all(fd, &add, &add_len, &add_cap) == -1) {
+      close(fd);
+      return -1;
+    }
+    text = add;
+    len = add_len;
+    src = PIECE_ADD;
+  }
+  close(fd);
+
+  if (len > 0 && text[len - 1] == '\n') len--;
+
+  vi_piece_t *root = NULL;
+  if (build_pieces(buf, text, len, src, &root) == -1) {
+    if (map) munmap(map, map_size);
+    free(add);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  free_tree(buf->root);
+  if (buf->map) munmap(buf->map, buf->map_size);
+  free(buf->add);
+  buf->root = root;
+  buf->map = map;
+  buf->map_size = map_size;
+  buf->add = add;
+  buf->add_len = add_len;
+  buf->add_cap = add_cap;
+  return 0;
+}
+
+
+size_t vi_buffer_size(const vi_buffer_t *buf) {
+  return sub_len(buf->root);
+}
+
+
+size_t vi_buffer_line_count(const vi_buffer_t *buf) {
+  return sub_lf(buf->root) + 1;
+}
+
+
+size_t vi_buffer_line_start(const vi_buffer_t *buf, size_t row) {
+  if (row == 0) return 0;
+  if (row > sub_lf(buf->root)) return sub_len(buf->root);
+
+  const vi_piece_t *t = buf->root;
+  size_t pos = 0;
+  while (t) {
+    size_t left_lf = sub_lf(t->left);
+    if (row <= left_lf) {
+      t = t->left;
+    } else if (row <= left_lf + t->lf) {
+      return pos + sub_len(t->left)
+             + jbox_linereader_nth(piece_data(buf, t), t->len,
+                                   row - left_lf) + 1;
+    } else {
+      row -= left_lf + t->lf;
+      pos += sub_len(t->left) + t->len;
+      t = t->right;
+    }
+  }
+  return pos;
+}
+
+
+size_t vi_buffer_line_length(const vi_buffer_t *buf, size_t row) {
+  size_t count = vi_buffer_line_count(buf);
+  if (row >= count) return 0;
+  size_t start = vi_buffer_line_start(buf, row);
+  size_t end = row + 1 < count ? vi_buffer_line_start(buf, row + 1) - 1
+                               : vi_buffer_size(buf);
+  return end - start;
+}
+
+
+size_t vi_buffer_line_of(const vi_buffer_t *buf, size_t pos) {
+  const vi_piece_t *t = buf->root;
+  size_t row = 0;
+  while (t) {
+    size_t left_len = sub_len(t->left);
+    if (pos < left_len) {
+      t = t->left;
+      continue;
+    }
+    row += sub_lf(t->left);
+    pos -= left_len;
+    if (pos < t->len) {
+      return row + jbox_linereader_count(piece_data(buf, t), pos);
+    }
+    row += t->lf;
+    pos -= t->len;
+    t = t->right;
+  }
+  return row;
+}
+
+
+const char *vi_buffer_line(vi_buffer_t *buf, size_t row, size_t *len) {
+  *len = 0;
+  size_t n = vi_buffer_line_length(buf, row);
+  if (n == 0) return "";
+
+  size_t start = vi_buffer_line_start(buf, row);
+  size_t off;
+  const vi_piece_t *p = locate(buf->root, start, &off);
+  if (p && p->len - off >= n) {
+    *len = n;
+    return piece_data(buf, p) + off;
+  }
+
+  if (n > buf->scratch_cap) {
+    char *scratch = realloc(buf->scratch, n);
+    if (!scratch) return "";
+    buf->scratch = scratch;
+    buf->scratch_cap = n;
+  }
+  *len = read_tree(buf, buf->root, start, buf->scratch, n);
+  return buf->scratch;
+}
+
+
+size_t vi_buffer_read(const vi_buffer_t *buf, size_t pos, char *dst,
+                      size_t len) {
+  return read_tree(buf, buf->root, pos, dst, len);
+}
+
+
+int vi_buffer_insert(vi_buffer_t *buf, size_t pos, const char *text,
+                     size_t len) {
+  if (len == 0) return 0;
+  size_t size = vi_buffer_size(buf);
+  if (pos > size) pos = size;
+
+  vi_piece_t *node = malloc(sizeof(*node));
+  vi_piece_t *spare = malloc(sizeof(*spare));
+  if (!node || !spare || reserve_add(buf, len) == -1) goto fail;
+
+  size_t add_end = buf->add_len;
+  memcpy(buf->add + add_end, text, len);
+  buf->add_len += len;
+  size_t lf = jbox_linereader_count(text, len);
+
+  if (extend(buf->root, pos, add_end, len, lf)) {
+    free(node);
+    free(spare);
+    return 0;
+  }
+
+  node->left = node->right = NULL;
+  node->prio = next_prio(buf);
+  node->src = PIECE_ADD;
+  node->off = add_end;
+  node->len = len;
+  node->lf = lf;
+  update(node);
+
+  vi_piece_t *l, *r;
+  split(buf, buf->root, pos, &l, &r, &spare);
+  buf->root = merge(merge(l, node), r);
+  free(spare);
+  return 0;
+
+fail:
+  free(node);
+  free(spare);
+  return -1;
+}
+
+
+int vi_buffer_delete(vi_buffer_t *buf, size_t pos, size_t len) {
+  vi_cut_t *cut;
+  if (vi_buffer_cut(buf, pos, len, &cut) == -1) return -1;
+  free_tree(cut);
+  return 0;
+}
+
+
+int vi_buffer_cut(vi_buffer_t *buf, size_t pos, size_t len, vi_cut_t **cut) {
+  *cut = NULL;
+  size_t size = vi_buffer_size(buf);
+  if (pos >= size || len == 0) return 0;
+  if (len > size - pos) len = size - pos;
+
+  vi_piece_t *spare1 = malloc(sizeof(*spare1));
+  vi_piece_t *spare2 = malloc(sizeof(*spare2));
+  if (!spare1 || !spare2) {
+    free(spare1);
+    free(spare2);
+    return -1;
+  }
+
+  vi_piece_t *l, *mid, *r;
+  split(buf, buf->root, pos, &l, &r, &spare1);
+  split(buf, r, len, &mid, &r, &spare2);
+  *cut = mid;
+  buf->root = merge(l, r);
+  free(spare1);
+  free(spare2);
+  return 0;
+}
+
+
+int vi_buffer_paste(vi_buffer_t *buf, size_t pos, vi_cut_t *cut) {
+  if (!cut) return 0;
+  size_t size = vi_buffer_size(buf);
+  if (pos > size) pos = size;
+
+  vi_piece_t *spare = malloc(sizeof(*spare));
+  if (!spare) return -1;
+
+  vi_piece_t *l, *r;
+  split(buf, buf->root, pos, &l, &r, &spare);
+  buf->root = merge(merge(l, cut), r);
+  free(spare);
+  return 0;
+}
+
+
+/** A pass over the old text of a range, building its new pieces */
+typedef struct {
+  vi_buffer_t *buf;
+  vi_piece_list_t old;        /* Pieces of the range as it was */
+  size_t i;                   /* Piece the pass is in */
+  size_t k;                   /* Offset within that piece */
+  vi_piece_list_t out;        /* New pieces */
+  size_t run;                 /* Start of copied text not yet in out */
+} replace_pass_t;
+
+
+/**
+ * Puts the text copied to the append buffer since the last call into
+ * new pieces.
+ * @return 0 on success, -1 if out of memory
+ */
+static int replace_flush(replace_pass_t *rp) {
+  vi_buffer_t *buf = rp->buf;
+  size_t run = rp->run;
+  rp->run = buf->add_len;
+  return list_add_chunks(&rp->out, PIECE_ADD, buf->add, run,
+                         buf->add_len - run);
+}
+
+
+/**
+ * Moves over n bytes of the old text, keeping them unless skip is set:
+ * copied to the append buffer if copy is set, else as pieces referring
+ * to where they are.
+ * @return 0 on success, -1 if out of memory
+ */
+static int replace_take(replace_pass_t *rp, size_t n, int skip, int copy) {
+  vi_buffer_t *buf = rp->buf;
+  if (!skip && !copy && replace_flush(rp) == -1) return -1;
+
+  while (n > 0) {
+    vi_piece_t *p = rp->old.items[rp->i];
+    size_t take = p->len - rp->k < n ? p->len - rp->k : n;
+    const char *data = piece_data(buf, p) + rp->k;
+    if (skip) {
+      /* Dropped */
+    } else if (copy) {
+      memcpy(buf->add + buf->add_len, data, take);
+      buf->add_len += take;
+    } else {
+      size_t lf = take == p->len ? p->lf : jbox_linereader_count(data, take);
+      if (list_add(&rp->out, p->src, p->off + rp->k, take, lf) == -1) {
+        return -1;
+      }
+    }
+    rp->k += take;
+    if (rp->k == p->len) {
+      rp->i++;
+      rp->k = 0;
+    }
+    n -= take;
+  }
+  return 0;
+}
+
+
+int vi_buffer_replace(vi_buffer_t *buf, size_t from, size_t to,
+                      const vi_replace_t *reps, size_t count,
+                      const char *text, vi_cut_t **cut) {
+  *cut = NULL;
+  size_t size = vi_buffer_size(buf);
+  if (to > size) to = size;
+  if (from > to) from = to;
+
+  /* Everything copied is reserved first, so that text being copied
+   * from the append buffer stays where it is */
+  size_t copy = 0;
+  size_t at = from;
+  for (size_t i = 0; i <= count; i++) {
+    size_t next = i < count ? reps[i].pos : to;
+    if (next - at < VI_REPLACE_COPY) copy += next - at;
+    if (i == count) break;
+    copy += reps[i].text_len;
+    at = reps[i].pos + reps[i].len;
+  }
+  vi_piece_t *spare = malloc(sizeof(*spare));
+  if (!spare || reserve_add(buf, copy) == -1) {
+    free(spare);
+    return -1;
+  }
+
+  vi_piece_t *old;
+  if (vi_buffer_cut(buf, from, to - from, &old) == -1) {
+    free(spare);
+    return -1;
+  }
+
+  size_t add_len = buf->add_len;
+  replace_pass_t rp = { .buf = buf, .run = buf->add_len };
+  if (list_tree(&rp.old, old) == -1) goto fail;
+
+  at = from;
+  for (size_t i = 0; i <= count; i++) {
+    size_t next = i < count ? reps[i].pos : to;
+    if (replace_take(&rp, next - at, 0, next - at < VI_REPLACE_COPY) == -1) {
+      goto fail;
+    }
+    if (i == count) break;
+    memcpy(buf->add + buf->add_len, text + reps[i].text_off,
+           reps[i].text_len);
+    buf->add_len += reps[i].text_len;
+    if (replace_take(&rp, reps[i].len, 1, 0) == -1) goto fail;
+    at = reps[i].pos + reps[i].len;
+  }
+  if (replace_flush(&rp) == -1) goto fail;
+
+  vi_piece_t *l, *r;
+  split(buf, buf->root, from, &l, &r, &spare);
+  buf->root = merge(merge(l, build(buf, rp.out.items, rp.out.count, 0)), r);
+  free(rp.out.items);
+  free(rp.old.items);
+  free(spare);
+  *cut = old;
+  return 0;
+
+fail:
+  list_free(&rp.out);
+  free(rp.old.items);
+  buf->add_len = add_len;
+  split(buf, buf->root, from, &l, &r, &spare);
+  buf->root = merge(merge(l, old), r);
+  free(spare);
+  return -1;
+}
+
+
+size_t vi_cut_length(const vi_cut_t *cut) {
+  return sub_len(cut);
+}
+
+
+vi_cut_t *vi_cut_join(vi_cut_t *a, vi_cut_t *b) {
+  return merge(a, b);
+}
+
+
+void vi_cut_free(vi_cut_t *cut) {
+  free_tree(cut);
+}
+
+
+size_t vi_buffer_spans(const vi_buffer_t *buf, size_t pos, struct iovec *iov,
+                       size_t max) {
+  size_t count = 0;
+  spans_tree(buf, buf->root, pos, iov, max, &count);
+  return count;
+}
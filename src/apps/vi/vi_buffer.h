@@ -0,0 +1,238 @@
+/** @file vi_buffer.h
+ *  @brief Piece table holding the text edited by vi
+ */
+
+#ifndef VI_BUFFER_H
+#define VI_BUFFER_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+
+/** Text buffer, private to vi_buffer.c */
+typedef struct vi_buffer vi_buffer_t;
+
+/**
+ * Text cut out of a buffer. It keeps the pieces that held the text, so
+ * it still points into the buffer's file mapping and append buffer and
+ * is only valid until the buffer is next loaded.
+ */
+typedef struct vi_piece vi_cut_t;
+
+/** One replacement of a batch: len bytes at pos become text_len bytes */
+typedef struct {
+  size_t pos;                 /* Offset in the text before the batch */
+  size_t len;
+  size_t text_off;            /* Start of the new text in the batch's */
+  size_t text_len;
+} vi_replace_t;
+
+
+/**
+ * Creates a buffer holding a single empty line.
+ *
+ * The text is a piece table: a sequence of pieces, each a span of
+ * either the original file, which is mapped and never copied, or an
+ * append-only buffer that receives everything typed or pasted. The
+ * pieces are kept in a balanced tree that records, for every subtree,
+ * its length in bytes and its number of newlines, so finding a line or
+ * inserting and deleting text costs O(log n) in the number of pieces.
+ *
+ * The text is the lines joined by '\n', without a final newline; a
+ * buffer always has at least one line.
+ *
+ * @return The buffer, or NULL if out of memory
+ */
+vi_buffer_t *vi_buffer_new(void);
+
+/**
+ * Frees a buffer and unmaps its file.
+ * @param buf Buffer to free; NULL is ignored
+ */
+void vi_buffer_free(vi_buffer_t *buf);
+
+/**
+ * Replaces the contents of a buffer with a file.
+ *
+ * A regular file is mapped, so loading it copies nothing; only its
+ * newlines are counted. Other files, such as pipes, are read into the
+ * append buffer. One final newline is dropped. On failure the buffer
+ * is left as it was.
+ *
+ * The mapping is private but still shows changes made to the file by
+ * others, so the file must not be rewritten in place while it is loaded.
+ *
+ * @param buf Buffer
+ * @param path File to load
+ * @return 0 on success, -1 on error (errno set)
+ */
+int vi_buffer_load(vi_buffer_t *buf, const char *path);
+
+/**
+ * Returns the length of the text in bytes.
+ * @param buf Buffer
+ * @return Length in bytes
+ */
+size_t vi_buffer_size(const vi_buffer_t *buf);
+
+/**
+ * Returns the number of lines, at least 1.
+ * @param buf Buffer
+ * @return Number of lines
+ */
+size_t vi_buffer_line_count(const vi_buffer_t *buf);
+
+/**
+ * Returns the offset of the first byte of a line.
+ * @param buf Buffer
+ * @param row Line number, from 0; past the last line gives the text size
+ * @return Offset in bytes
+ */
+size_t vi_buffer_line_start(const vi_buffer_t *buf, size_t row);
+
+/**
+ * Returns the length of a line without its newline.
+ * @param buf Buffer
+ * @param row Line number, from 0
+ * @return Length in bytes, 0 past the last line
+ */
+size_t vi_buffer_line_length(const vi_buffer_t *buf, size_t row);
+
+/**
+ * Returns the line holding a byte.
+ * @param buf Buffer
+ * @param pos Offset of the byte
+ * @return Line number, from 0
+ */
+size_t vi_buffer_line_of(const vi_buffer_t *buf, size_t pos);
+
+/**
+ * Returns the text of a line, without its newline.
+ *
+ * A line that lies within one piece is returned in place; one that
+ * spans pieces is copied into storage owned by the buffer. Either way
+ * the text is valid only until the buffer is next changed or this is
+ * next called.
+ *
+ * @param buf Buffer
+ * @param row Line number, from 0
+ * @param len Set to the length of the line
+ * @return The text, not NUL-terminated; "" with len 0 past the last
+ *         line or if out of memory
+ */
+const char *vi_buffer_line(vi_buffer_t *buf, size_t row, size_t *len);
+
+/**
+ * Copies part of the text.
+ * @param buf Buffer
+ * @param pos Offset to copy from
+ * @param dst Destination
+ * @param len Number of bytes to copy
+ * @return Number of bytes copied, less than len at the end of the text
+ */
+size_t vi_buffer_read(const vi_buffer_t *buf, size_t pos, char *dst,
+                      size_t len);
+
+/**
+ * Inserts text.
+ *
+ * Consecutive insertions at the end of the text just inserted, as when
+ * typing, extend the same piece rather than adding one per keystroke.
+ *
+ * @param buf Buffer
+ * @param pos Offset to insert at; clamped to the text size
+ * @param text Text to insert
+ * @param len Length of text
+ * @return 0 on success, -1 if out of memory
+ */
+int vi_buffer_insert(vi_buffer_t *buf, size_t pos, const char *text,
+                     size_t len);
+
+/**
+ * Deletes text.
+ * @param buf Buffer
+ * @param pos Offset of the first byte to delete
+ * @param len Number of bytes to delete; clipped to the end of the text
+ * @return 0 on success, -1 if out of memory
+ */
+int vi_buffer_delete(vi_buffer_t *buf, size_t pos, size_t len);
+
+/**
+ * Deletes text and keeps it, as the pieces that held it, so that it can
+ * be put back without copying.
+ * @param buf Buffer
+ * @param pos Offset of the first byte to cut
+ * @param len Number of bytes to cut; clipped to the end of the text
+ * @param cut Set to the text cut, or NULL if there was none
+ * @return 0 on success, -1 if out of memory (nothing is cut)
+ */
+int vi_buffer_cut(vi_buffer_t *buf, size_t pos, size_t len, vi_cut_t **cut);
+
+/**
+ * Inserts text cut from the same buffer.
+ * @param buf Buffer
+ * @param pos Offset to insert at; clamped to the text size
+ * @param cut Text to insert, owned by the buffer on success; NULL is
+ *            ignored
+ * @return 0 on success, -1 if out of memory (cut is still the caller's)
+ */
+int vi_buffer_paste(vi_buffer_t *buf, size_t pos, vi_cut_t *cut);
+
+/**
+ * Makes many replacements in a range of the text as one edit.
+ *
+ * The range is cut out, as by vi_buffer_cut(), and a new run of pieces
+ * put in its place. Long stretches left alone between replacements
+ * become pieces that refer to the same bytes as before, without
+ * copying; short ones are copied to the append buffer together with the
+ * new text around them, so a replacement in every line does not leave
+ * a piece per line. The cost is one pass over the range, whatever the
+ * number of replacements.
+ *
+ * @param buf Buffer
+ * @param from Offset the range starts at
+ * @param to Offset the range ends at; clipped to the end of the text
+ * @param reps Replacements, in order, not overlapping, within the range
+ * @param count Number of replacements
+ * @param text New text the replacements refer to
+ * @param cut Set to the text of the range as it was, or NULL if empty
+ * @return 0 on success, -1 if out of memory (nothing is changed)
+ */
+int vi_buffer_replace(vi_buffer_t *buf, size_t from, size_t to,
+                      const vi_replace_t *reps, size_t count,
+                      const char *text, vi_cut_t **cut);
+
+/**
+ * Returns the length of cut text.
+ * @param cut Cut text; NULL gives 0
+ * @return Length in bytes
+ */
+size_t vi_cut_length(const vi_cut_t *cut);
+
+/**
+ * Joins two pieces of cut text.
+ * @param a Text that comes first; NULL is allowed
+ * @param b Text that follows; NULL is allowed
+ * @return The joined text, which owns both
+ */
+vi_cut_t *vi_cut_join(vi_cut_t *a, vi_cut_t *b);
+
+/**
+ * Frees cut text.
+ * @param cut Cut text; NULL is ignored
+ */
+void vi_cut_free(vi_cut_t *cut);
+
+/**
+ * Describes the text from an offset as spans of memory, in order, for
+ * writing out without copying.
+ * @param buf Buffer
+ * @param pos Offset to start at
+ * @param iov Array to fill
+ * @param max Number of entries in iov
+ * @return Number of entries filled; 0 at the end of the text
+ */
+size_t vi_buffer_spans(const vi_buffer_t *buf, size_t pos, struct iovec *iov,
+                       size_t max);
+
+#endif
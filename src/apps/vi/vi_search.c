@@ -0,0 +1,472 @@
+/** @file vi_search.c
+ *  @brief Pattern search and substitution over vi's buffer
+ *
+ * The buffer is never flattened for a search: its spans are walked in
+ * order and each run of whole lines in a span is handed to the matcher
+ * where it lies, in the file mapping or the append buffer. Only a line
+ * split between pieces is copied. Patterns are compiled with REG_NEWLINE,
+ * so one call matches through a run of lines without crossing a line end.
+ *
+ * A substitution only reads the buffer while it looks for matches, so it
+ * runs on a thread of its own while the editor shows its progress. It
+ * produces a list of replacements that vi_buffer_replace() then makes as
+ * a single edit.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "utils/jbox_regex.h"
+#include "vi_search.h"
+
+
+/** Spans of the buffer fetched at a time */
+#define VI_SCAN_SPANS 64
+
+/** Groups a replacement can refer to, \0 to \9 */
+#define VI_SUBST_GROUPS 10
+
+struct vi_pattern {
+  char *literal;              /* Pattern found with memmem(), or NULL */
+  size_t literal_len;
+  jbox_regex_t regex;         /* Compiled pattern unless literal */
+};
+
+/** What the substitution thread keeps while scanning */
+typedef struct {
+  vi_subst_t *sub;
+  int plain;                  /* Replacement is the same for every match */
+  size_t line_end;            /* End of the last line with a replacement */
+} subst_scan_t;
+
+
+vi_pattern_t *vi_pattern_new(const char *pattern, int icase, char *err,
+                             size_t errsize) {
+  vi_pattern_t *pat = calloc(1, sizeof(*pat));
+  if (!pat) {
+    snprintf(err, errsize, "Out of memory");
+    return NULL;
+  }
+
+  if (!icase && pattern[0] != '\0' &&
+      strpbrk(pattern, ".[]()*+?{}|^$\\") == NULL) {
+    pat->literal = strdup(pattern);
+    if (!pat->literal) {
+      snprintf(err, errsize, "Out of memory");
+      free(pat);
+      return NULL;
+    }
+    pat->literal_len = strlen(pattern);
+    return pat;
+  }
+
+  int cflags = REG_EXTENDED | REG_NEWLINE;
+  if (icase) cflags |= REG_ICASE;
+  int ret = jbox_regex_compile(&pat->regex, pattern, cflags);
+  if (ret != 0) {
+    jbox_regex_error(ret, &pat->regex, err, errsize);
+    free(pat);
+    return NULL;
+  }
+  return pat;
+}
+
+
+void vi_pattern_free(vi_pattern_t *pat) {
+  if (!pat) return;
+  if (pat->literal) {
+    free(pat->literal);
+  } else {
+    jbox_regex_free(&pat->regex);
+  }
+  free(pat);
+}
+
+
+/**
+ * Finds the first match in text that starts at or after at.
+ * @return 1 with so and eo set, 0 if there is none
+ */
+static int next_match(vi_pattern_t *pat, const char *text, size_t len,
+                      size_t at, size_t *so, size_t *eo) {
+  if (pat->literal) {
+    const char *hit = memmem(text + at, len - at, pat->literal,
+                             pat->literal_len);
+    if (!hit) return 0;
+    *so = (size_t)(hit - text);
+    *eo = *so + pat->literal_len;
+    return 1;
+  }
+
+  regmatch_t m;
+  if (jbox_regex_exec_at(&pat->regex, text, len, at, &m) != 0) return 0;
+  *so = (size_t)m.rm_so;
+  *eo = (size_t)m.rm_eo;
+  return 1;
+}
+
+
+/**
+ * Matches whole lines, text[0, len), found at offset base of the buffer.
+ * @param from Offset in the buffer to search from
+ * @return As vi_pattern_scan()
+ */
+static int scan_lines(vi_pattern_t *pat, const char *text, size_t len,
+                      size_t base, size_t from, int global, vi_match_fn fn,
+                      void *arg) {
+  size_t at = from > base ? from - base : 0;
+  size_t last_end = (size_t)-1;
+  size_t so, eo;
+  while (at <= len && next_match(pat, text, len, at, &so, &eo)) {
+    /* An empty match after the last newline belongs to the next line */
+    if (so == len && len > 0 && text[len - 1] == '\n') break;
+    /* Nor does an empty match count right after a match */
+    if (so == eo && so == last_end) {
+      at = so + 1;
+      continue;
+    }
+
+    int ret = fn(arg, text, len, base, so, eo);
+    if (ret != 0) return ret;
+
+    if (!global) {
+      const char *nl = memchr(text + so, '\n', len - so);
+      if (!nl) break;
+      at = (size_t)(nl - text) + 1;
+      last_end = (size_t)-1;
+    } else {
+      at = eo > so ? eo : so + 1;
+      last_end = eo;
+    }
+  }
+  return 0;
+}
+
+
+/**
+ * Appends to a growing buffer.
+ * @return 0 on success, -1 if out of memory
+ */
+static int append(char **data, size_t *len, size_t *cap, const char *add,
+                  size_t add_len) {
+  if (*len + add_len > *cap) {
+    size_t new_cap = *cap ? *cap : 4096;
+    while (new_cap < *len + add_len) new_cap *= 2;
+    char *grown = realloc(*data, new_cap);
+    if (!grown) return -1;
+    *data = grown;
+    *cap = new_cap;
+  }
+  memcpy(*data + *len, add, add_len);
+  *len += add_len;
+  return 0;
+}
+
+
+int vi_pattern_scan(vi_pattern_t *pat, vi_buffer_t *buf, size_t from,
+                    size_t to, int global, vi_match_fn fn, void *arg,
+                    atomic_size_t *scanned, atomic_int *cancel) {
+  size_t size = vi_buffer_size(buf);
+  if (to > size) to = size;
+  if (from > to) return 0;
+
+  size_t start = vi_buffer_line_start(buf, vi_buffer_line_of(buf, from));
+  char *carry = NULL;         /* A line split between pieces */
+  size_t carry_len = 0;
+  size_t carry_cap = 0;
+  size_t carry_base = start;
+  size_t pos = start;
+  char last = '\n';           /* Byte before pos */
+  int ret = 0;
+
+  while (pos < to && ret == 0) {
+    if (cancel && atomic_load(cancel)) {
+      ret = -1;
+      break;
+    }
+    struct iovec iov[VI_SCAN_SPANS];
+    size_t count = vi_buffer_spans(buf, pos, iov, VI_SCAN_SPANS);
+    if (count == 0) break;
+
+    for (size_t i = 0; i < count && pos < to && ret == 0; i++) {
+      const char *data = iov[i].iov_base;
+      size_t n = iov[i].iov_len;
+      if (n > to - pos) n = to - pos;
+
+      /* Finish the line carried over from the spans before */
+      size_t used = 0;
+      if (carry_len > 0) {
+        const char *nl = memchr(data, '\n', n);
+        used = nl ? (size_t)(nl - data) + 1 : n;
+        if (append(&carry, &carry_len, &carry_cap, data, used) == -1) {
+          ret = -1;
+          break;
+        }
+        if (nl) {
+          ret = scan_lines(pat, carry, carry_len, carry_base, from, global,
+                           fn, arg);
+          carry_len = 0;
+        }
+      }
+
+      /* Match the whole lines in place and carry the rest */
+      if (used < n && ret == 0) {
+        const char *rest = data + used;
+        size_t rest_len = n - used;
+        const char *nl = memrchr(rest, '\n', rest_len);
+        size_t whole = nl ? (size_t)(nl - rest) + 1 : 0;
+        if (whole > 0) {
+          ret = scan_lines(pat, rest, whole, pos + used, from, global, fn,
+                           arg);
+        }
+        if (whole < rest_len && ret == 0) {
+          carry_base = pos + used + whole;
+          if (append(&carry, &carry_len, &carry_cap, rest + whole,
+                     rest_len - whole) == -1) {
+            ret = -1;
+          }
+        }
+      }
+
+      pos += n;
+      if (n > 0) last = data[n - 1];
+      if (scanned) atomic_store(scanned, pos - start);
+    }
+  }
+
+  if (ret == 0 && carry_len > 0) {
+    ret = scan_lines(pat, carry, carry_len, carry_base, from, global, fn,
+                     arg);
+  } else if (ret == 0 && pos >= to && last == '\n') {
+    /* The range ends with an empty line, which has no bytes to walk */
+    ret = scan_lines(pat, "", 0, to, from, global, fn, arg);
+  }
+  free(carry);
+  return ret;
+}
+
+
+/** The first match found by vi_pattern_find() */
+typedef struct {
+  size_t to;
+  size_t pos;
+  size_t len;
+} find_t;
+
+
+static int find_first(void *arg, const char *text, size_t len, size_t base,
+                      size_t so, size_t eo) {
+  (void)text;
+  (void)len;
+  find_t *find = arg;
+  if (base + so < find->to) {
+    find->pos = base + so;
+    find->len = eo - so;
+  }
+  return 1;
+}
+
+
+size_t vi_pattern_find(vi_pattern_t *pat, vi_buffer_t *buf, size_t from,
+                       size_t to, size_t *len) {
+  find_t find = { .to = to, .pos = (size_t)-1, .len = 0 };
+  if (from >= to) return (size_t)-1;
+
+  /* The match may end past to, but not past its line */
+  size_t row = vi_buffer_line_of(buf, to - 1);
+  size_t end = vi_buffer_line_start(buf, row) +
+               vi_buffer_line_length(buf, row);
+  vi_pattern_scan(pat, buf, from, end, 1, find_first, &find, NULL, NULL);
+  *len = find.len;
+  return find.pos;
+}
+
+
+/**
+ * Finds the groups of a match, by running the POSIX engine on a copy of
+ * its line: the text is not NUL-terminated, which regexec() may read up
+ * to even with REG_STARTEND.
+ * @param groups Set to the groups, as offsets in text
+ * @return Number of groups set, at least 1 (the whole match)
+ */
+static size_t match_groups(vi_pattern_t *pat, const char *text, size_t len,
+                           size_t so, size_t eo, regmatch_t *groups) {
+  groups[0].rm_so = (regoff_t)so;
+  groups[0].rm_eo = (regoff_t)eo;
+  if (pat->literal) return 1;
+
+  size_t start = so;
+  while (start > 0 && text[start - 1] != '\n') start--;
+  const char *nl = memchr(text + eo, '\n', len - eo);
+  size_t end = nl ? (size_t)(nl - text) : len;
+  char *line = malloc(end - start + 1);
+  if (!line) return 1;
+  memcpy(line, text + start, end - start);
+  line[end - start] = '\0';
+
+  regmatch_t found[VI_SUBST_GROUPS];
+  found[0].rm_so = (regoff_t)(so - start);
+  found[0].rm_eo = (regoff_t)(end - start);
+  int flags = REG_STARTEND;
+  if (so > start) flags |= REG_NOTBOL;
+  int rc = regexec(&pat->regex.posix, line, VI_SUBST_GROUPS, found, flags);
+  free(line);
+  if (rc != 0 || (size_t)found[0].rm_so != so - start) return 1;
+
+  for (size_t i = 1; i < VI_SUBST_GROUPS; i++) {
+    if (found[i].rm_so < 0) {
+      groups[i] = found[i];
+      continue;
+    }
+    groups[i].rm_so = found[i].rm_so + (regoff_t)start;
+    groups[i].rm_eo = found[i].rm_eo + (regoff_t)start;
+  }
+  return VI_SUBST_GROUPS;
+}
+
+
+/**
+ * Appends the replacement for a match to the substitution's text: & and
+ * \0 are the match, \1 to \9 its groups, and \n, \r and \t a newline,
+ * newline and tab.
+ * @return 0 on success, -1 if out of memory
+ */
+static int expand(vi_subst_t *sub, const char *text, size_t len, size_t so,
+                  size_t eo) {
+  regmatch_t groups[VI_SUBST_GROUPS];
+  size_t ngroups = 0;
+
+  for (const char *r = sub->repl; *r; r++) {
+    const char *add = r;
+    size_t add_len = 1;
+    int group = -1;
+    if (*r == '&') {
+      group = 0;
+    } else if (*r == '\\' && r[1] != '\0') {
+      r++;
+      add = r;
+      if (*r >= '0' && *r <= '9') group = *r - '0';
+      else if (*r == 'n' || *r == 'r') add = "\n";
+      else if (*r == 't') add = "\t";
+    }
+
+    if (group == 0) {
+      add = text + so;
+      add_len = eo - so;
+    } else if (group > 0) {
+      if (ngroups == 0) {
+        ngroups = match_groups(sub->pat, text, len, so, eo, groups);
+      }
+      if ((size_t)group >= ngroups || groups[group].rm_so < 0) continue;
+      add = text + groups[group].rm_so;
+      add_len = (size_t)(groups[group].rm_eo - groups[group].rm_so);
+    }
+    if (append(&sub->text, &sub->text_len, &sub->text_cap, add,
+               add_len) == -1) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+
+static int subst_match(void *arg, const char *text, size_t len, size_t base,
+                       size_t so, size_t eo) {
+  subst_scan_t *scan = arg;
+  vi_subst_t *sub = scan->sub;
+  if (atomic_load_explicit(&sub->cancel, memory_order_relaxed)) return -1;
+
+  size_t text_off = 0;
+  size_t text_len = sub->text_len;
+  if (!scan->plain) {
+    text_off = sub->text_len;
+    if (expand(sub, text, len, so, eo) == -1) return -1;
+    text_len = sub->text_len - text_off;
+  }
+
+  if (sub->count == sub->cap) {
+    size_t cap = sub->cap ? sub->cap * 2 : 1024;
+    vi_replace_t *reps = realloc(sub->reps, cap * sizeof(*reps));
+    if (!reps) return -1;
+    sub->reps = reps;
+    sub->cap = cap;
+  }
+  sub->reps[sub->count++] = (vi_replace_t){
+    .pos = base + so,
+    .len = eo - so,
+    .text_off = text_off,
+    .text_len = text_len
+  };
+
+  if (sub->lines == 0 || base + so > scan->line_end) {
+    const char *nl = memchr(text + so, '\n', len - so);
+    scan->line_end = base + (nl ? (size_t)(nl - text) : len);
+    sub->lines++;
+  }
+  return 0;
+}
+
+
+/**
+ * Substitution thread: finds every replacement in the range.
+ */
+static void *subst_worker(void *arg) {
+  vi_subst_t *sub = arg;
+  subst_scan_t scan = { .sub = sub };
+
+  /* Without & or groups, every match gets the same text, kept once */
+  scan.plain = strchr(sub->repl, '&') == NULL;
+  for (const char *r = sub->repl; scan.plain && *r; r++) {
+    if (*r == '\\' && r[1] != '\0') {
+      r++;
+      if (*r >= '0' && *r <= '9') scan.plain = 0;
+    }
+  }
+  if (scan.plain && expand(sub, "", 0, 0, 0) == -1) {
+    sub->error = 1;
+    atomic_store(&sub->done, 1);
+    return NULL;
+  }
+
+  if (vi_pattern_scan(sub->pat, sub->buf, sub->from, sub->to, sub->global,
+                      subst_match, &scan, &sub->scanned,
+                      &sub->cancel) != 0) {
+    sub->error = 1;
+  }
+  atomic_store(&sub->done, 1);
+  return NULL;
+}
+
+
+int vi_subst_start(vi_subst_t *sub) {
+  atomic_init(&sub->scanned, 0);
+  atomic_init(&sub->cancel, 0);
+  atomic_init(&sub->done, 0);
+  sub->reps = NULL;
+  sub->count = 0;
+  sub->cap = 0;
+  sub->text = NULL;
+  sub->text_len = 0;
+  sub->text_cap = 0;
+  sub->lines = 0;
+  sub->error = 0;
+  return pthread_create(&sub->thread, NULL, subst_worker, sub) == 0 ? 0 : -1;
+}
+
+
+void vi_subst_wait(vi_subst_t *sub) {
+  pthread_join(sub->thread, NULL);
+}
+
+
+void vi_subst_free(vi_subst_t *sub) {
+  free(sub->reps);
+  free(sub->text);
+  sub->reps = NULL;
+  sub->text = NULL;
+  sub->count = 0;
+}
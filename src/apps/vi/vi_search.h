@@ -0,0 +1,137 @@
+/** @file vi_search.h
+ *  @brief Pattern search and substitution over vi's buffer
+ */
+
+#ifndef VI_SEARCH_H
+#define VI_SEARCH_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "vi_buffer.h"
+
+
+/** Compiled pattern, private to vi_search.c */
+typedef struct vi_pattern vi_pattern_t;
+
+/**
+ * Called for each match found by vi_pattern_scan().
+ * @param arg Argument given to vi_pattern_scan()
+ * @param text Whole lines holding the match
+ * @param len Length of text
+ * @param base Offset of text in the buffer
+ * @param so Offset of the match in text
+ * @param eo Offset of the end of the match in text
+ * @return 0 to go on, 1 to stop, -1 to stop on error
+ */
+typedef int (*vi_match_fn)(void *arg, const char *text, size_t len,
+                           size_t base, size_t so, size_t eo);
+
+/**
+ * A substitution found by a thread of its own. The fields up to
+ * scanned are set by the caller; the results are valid once
+ * vi_subst_wait() returns.
+ */
+typedef struct {
+  vi_pattern_t *pat;
+  vi_buffer_t *buf;           /* Not to be changed until the wait */
+  size_t from;                /* Range of whole lines to substitute in */
+  size_t to;
+  const char *repl;           /* Replacement, with & and \1 to \9 */
+  int global;                 /* Every match in a line, not the first */
+
+  atomic_size_t scanned;      /* Bytes of the range done so far */
+  atomic_int cancel;          /* Set to stop early */
+  atomic_int done;            /* Set when the thread has finished */
+  pthread_t thread;
+
+  vi_replace_t *reps;         /* Replacements found, in order */
+  size_t count;
+  size_t cap;
+  char *text;                 /* New text the replacements refer to */
+  size_t text_len;
+  size_t text_cap;
+  size_t lines;               /* Lines with a replacement */
+  int error;                  /* Out of memory or cancelled */
+} vi_subst_t;
+
+
+/**
+ * Compiles a pattern.
+ *
+ * Patterns are POSIX extended regular expressions, matched a line at a
+ * time by the DFA engine of jbox_regex.h; one with no special characters
+ * is found with memmem() instead.
+ *
+ * @param pattern Pattern text
+ * @param icase Non-zero to ignore case
+ * @param err Set to a description of the error, if any
+ * @param errsize Size of err
+ * @return The pattern, or NULL on error
+ */
+vi_pattern_t *vi_pattern_new(const char *pattern, int icase, char *err,
+                             size_t errsize);
+
+/**
+ * Frees a pattern.
+ * @param pat Pattern; NULL is ignored
+ */
+void vi_pattern_free(vi_pattern_t *pat);
+
+/**
+ * Finds the matches in the text from an offset up to a line end.
+ *
+ * The text is walked as the buffer's spans of memory. Runs of whole
+ * lines within a span are matched in place, and only a line that spans
+ * pieces is copied. Matches do not cross line ends.
+ *
+ * @param pat Pattern
+ * @param buf Buffer
+ * @param from Offset to search from; the line it is in is still seen
+ *        for ^ and word boundaries
+ * @param to Offset of the end of the last line to search
+ * @param global Non-zero for every match in a line, zero for the first
+ * @param fn Called for each match
+ * @param arg Passed to fn
+ * @param scanned If not NULL, set to the bytes done as the walk goes
+ * @param cancel If not NULL, the walk stops once it is set
+ * @return 0 at the end of the range, 1 if fn stopped it, -1 on error or
+ *         if cancelled
+ */
+int vi_pattern_scan(vi_pattern_t *pat, vi_buffer_t *buf, size_t from,
+                    size_t to, int global, vi_match_fn fn, void *arg,
+                    atomic_size_t *scanned, atomic_int *cancel);
+
+/**
+ * Finds the first match that starts in [from, to).
+ * @param pat Pattern
+ * @param buf Buffer
+ * @param from Offset to search from
+ * @param to Offset the match must start before
+ * @param len Set to the length of the match
+ * @return Offset of the match, or (size_t)-1 if there is none
+ */
+size_t vi_pattern_find(vi_pattern_t *pat, vi_buffer_t *buf, size_t from,
+                       size_t to, size_t *len);
+
+/**
+ * Starts finding the replacements of a substitution on another thread.
+ * @param sub Substitution, with the fields up to scanned set
+ * @return 0 on success, -1 if the thread could not be started
+ */
+int vi_subst_start(vi_subst_t *sub);
+
+/**
+ * Waits for a substitution's thread to finish.
+ * @param sub Substitution
+ */
+void vi_subst_wait(vi_subst_t *sub);
+
+/**
+ * Frees the results of a substitution.
+ * @param sub Substitution
+ */
+void vi_subst_free(vi_subst_t *sub);
+
+#endif
@@ -0,0 +1,334 @@
+/** @file vi_swap.c
+ *  @brief Swap file journaling vi's unsaved edits
+ *
+ * Layout: a swap_header_t naming the file the journal starts from, then
+ * swap_record_t records, each insertion followed by the text inserted.
+ * Offsets are into the text as vi_buffer holds it. A record cut short by
+ * a crash ends the journal.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "vi_swap.h"
+
+
+#define VI_SWAP_MAGIC "JVISWAP1"
+
+/** Queued bytes that trigger a flush without waiting for the editor */
+#define VI_SWAP_QUEUE_LIMIT (64 * 1024)
+
+/** Identity of the file the journal starts from */
+typedef struct {
+  char magic[8];
+  uint64_t size;
+  int64_t mtime_ns;
+  uint64_t ino;               /* 0 if the file did not exist */
+  uint64_t dev;
+} swap_header_t;
+
+typedef enum {
+  SWAP_INSERT = 1,
+  SWAP_DELETE = 2
+} swap_op_t;
+
+/** One edit; an insertion is followed by len bytes of text */
+typedef struct {
+  uint32_t op;
+  uint32_t reserved;
+  uint64_t pos;
+  uint64_t len;
+} swap_record_t;
+
+struct vi_swap {
+  int fd;
+  char *path;                 /* Swap file */
+  char *queue;                /* Records not yet written */
+  size_t queue_len;
+  size_t queue_cap;
+  size_t last;                /* Offset of the last queued record, or
+                                 SIZE_MAX if it was written out */
+};
+
+
+/**
+ * Fills a header with the identity of path as it is now.
+ */
+static void make_header(const char *path, swap_header_t *hdr) {
+  memset(hdr, 0, sizeof(*hdr));
+  memcpy(hdr->magic, VI_SWAP_MAGIC, sizeof(hdr->magic));
+  struct stat st;
+  if (stat(path, &st) == 0) {
+    hdr->size = (uint64_t)st.st_size;
+    hdr->mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 +
+                    st.st_mtim.tv_nsec;
+    hdr->ino = (uint64_t)st.st_ino;
+    hdr->dev = (uint64_t)st.st_dev;
+  }
+}
+
+
+/**
+ * Writes all of buf to fd, retrying on EINTR and short writes.
+ * @return 0 on success, -1 on error (errno set)
+ */
+static int write_all(int fd, const void *buf, size_t len) {
+  const char *p = buf;
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+
+/**
+ * Makes room for n more bytes in the queue.
+ * @return 0 on success, -1 if out of memory
+ */
+static int queue_reserve(vi_swap_t *swap, size_t n) {
+  if (swap->queue_len + n <= swap->queue_cap) return 0;
+  size_t cap = swap->queue_cap ? swap->queue_cap : 4096;
+  while (cap < swap->queue_len + n) cap *= 2;
+  char *queue = realloc(swap->queue, cap);
+  if (!queue) return -1;
+  swap->queue = queue;
+  swap->queue_cap = cap;
+  return 0;
+}
+
+
+/**
+ * Copies out the last queued record; records in the queue are not
+ * aligned.
+ * @return 1 if there is one, 0 if the queue is empty
+ */
+static int get_last(const vi_swap_t *swap, swap_record_t *rec) {
+  if (swap->last == SIZE_MAX) return 0;
+  memcpy(rec, swap->queue + swap->last, sizeof(*rec));
+  return 1;
+}
+
+
+/**
+ * Stores back the last queued record after changing it.
+ */
+static void put_last(vi_swap_t *swap, const swap_record_t *rec) {
+  memcpy(swap->queue + swap->last, rec, sizeof(*rec));
+}
+
+
+/**
+ * Queues a record, with text for an insertion.
+ */
+static int queue_record(vi_swap_t *swap, swap_op_t op, size_t pos,
+                        const char *text, size_t len) {
+  size_t n = sizeof(swap_record_t) + (op == SWAP_INSERT ? len : 0);
+  if (queue_reserve(swap, n) == -1) return -1;
+
+  swap_record_t rec = { .op = op, .pos = pos, .len = len };
+  swap->last = swap->queue_len;
+  memcpy(swap->queue + swap->queue_len, &rec, sizeof(rec));
+  if (op == SWAP_INSERT) {
+    memcpy(swap->queue + swap->queue_len + sizeof(rec), text, len);
+  }
+  swap->queue_len += n;
+
+  if (swap->queue_len >= VI_SWAP_QUEUE_LIMIT) vi_swap_flush(swap);
+  return 0;
+}
+
+
+int vi_swap_path(const char *path, char *out, size_t size) {
+  int n = snprintf(out, size, "%s.swp", path);
+  return n < 0 || (size_t)n >= size ? -1 : 0;
+}
+
+
+vi_swap_t *vi_swap_open(const char *path, int resume) {
+  vi_swap_t *swap = calloc(1, sizeof(*swap));
+  if (!swap) return NULL;
+  swap->last = SIZE_MAX;
+
+  size_t size = strlen(path) + sizeof(".swp");
+  swap->path = malloc(size);
+  if (!swap->path || vi_swap_path(path, swap->path, size) == -1) {
+    free(swap->path);
+    free(swap);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  int flags = O_WRONLY | O_APPEND | O_CLOEXEC;
+  if (!resume) flags |= O_CREAT | O_EXCL;
+  swap->fd = open(swap->path, flags, 0600);
+  if (swap->fd == -1) {
+    int saved = errno;
+    free(swap->path);
+    free(swap);
+    errno = saved;
+    return NULL;
+  }
+
+  if (!resume) {
+    swap_header_t hdr;
+    make_header(path, &hdr);
+    if (write_all(swap->fd, &hdr, sizeof(hdr)) == -1) {
+      int saved = errno;
+      vi_swap_close(swap, 0);
+      errno = saved;
+      return NULL;
+    }
+  }
+  return swap;
+}
+
+
+void vi_swap_close(vi_swap_t *swap, int keep) {
+  if (!swap) return;
+  if (keep) {
+    vi_swap_flush(swap);
+  } else {
+    unlink(swap->path);
+  }
+  close(swap->fd);
+  free(swap->path);
+  free(swap->queue);
+  free(swap);
+}
+
+
+int vi_swap_insert(vi_swap_t *swap, size_t pos, const char *text,
+                   size_t len) {
+  if (!swap || len == 0) return 0;
+
+  /* Typing extends the insertion it follows, whose text ends the queue */
+  swap_record_t last;
+  if (get_last(swap, &last) && last.op == SWAP_INSERT &&
+      last.pos + last.len == pos) {
+    if (queue_reserve(swap, len) == -1) return -1;
+    memcpy(swap->queue + swap->queue_len, text, len);
+    swap->queue_len += len;
+    last.len += len;
+    put_last(swap, &last);
+    if (swap->queue_len >= VI_SWAP_QUEUE_LIMIT) vi_swap_flush(swap);
+    return 0;
+  }
+  return queue_record(swap, SWAP_INSERT, pos, text, len);
+}
+
+
+int vi_swap_delete(vi_swap_t *swap, size_t pos, size_t len) {
+  if (!swap || len == 0) return 0;
+
+  /* Repeated x deletes at the same place, backspace just before it */
+  swap_record_t last;
+  if (get_last(swap, &last) && last.op == SWAP_DELETE &&
+      (last.pos == pos || pos + len == last.pos)) {
+    last.pos = pos;
+    last.len += len;
+    put_last(swap, &last);
+    return 0;
+  }
+  return queue_record(swap, SWAP_DELETE, pos, NULL, len);
+}
+
+
+int vi_swap_flush(vi_swap_t *swap) {
+  if (!swap || swap->queue_len == 0) return 0;
+  int rc = write_all(swap->fd, swap->queue, swap->queue_len);
+  swap->queue_len = 0;
+  swap->last = SIZE_MAX;
+  return rc;
+}
+
+
+int vi_swap_reset(vi_swap_t *swap, const char *path) {
+  if (!swap) return 0;
+  swap->queue_len = 0;
+  swap->last = SIZE_MAX;
+
+  swap_header_t hdr;
+  make_header(path, &hdr);
+  if (ftruncate(swap->fd, 0) == -1) return -1;
+  return write_all(swap->fd, &hdr, sizeof(hdr));
+}
+
+
+long vi_swap_recover(const char *path, vi_buffer_t *buf) {
+  char swap_path[PATH_MAX];
+  if (vi_swap_path(path, swap_path, sizeof(swap_path)) == -1) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  int fd = open(swap_path, O_RDWR | O_CLOEXEC);
+  if (fd == -1) return -1;
+
+  FILE *fp = fdopen(fd, "r");
+  if (!fp) {
+    close(fd);
+    return -1;
+  }
+
+  swap_header_t hdr, now;
+  make_header(path, &now);
+  if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+      memcmp(hdr.magic, VI_SWAP_MAGIC, sizeof(hdr.magic)) != 0) {
+    fclose(fp);
+    errno = EINVAL;
+    return -1;
+  }
+  if (hdr.size != now.size || hdr.mtime_ns != now.mtime_ns ||
+      hdr.ino != now.ino || hdr.dev != now.dev) {
+    fclose(fp);
+    errno = ESTALE;
+    return -1;
+  }
+
+  long count = 0;
+  off_t valid = (off_t)sizeof(hdr);
+  char *text = NULL;
+  size_t text_cap = 0;
+  swap_record_t rec;
+  while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+    size_t size = vi_buffer_size(buf);
+    if (rec.op == SWAP_INSERT) {
+      if (rec.pos > size) break;
+      if (rec.len > text_cap) {
+        char *grown = realloc(text, rec.len);
+        if (!grown) break;
+        text = grown;
+        text_cap = rec.len;
+      }
+      if (fread(text, 1, rec.len, fp) != rec.len) break;
+      if (vi_buffer_insert(buf, rec.pos, text, rec.len) == -1) break;
+    } else if (rec.op == SWAP_DELETE) {
+      if (rec.pos > size || rec.len > size - rec.pos) break;
+      if (vi_buffer_delete(buf, rec.pos, rec.len) == -1) break;
+    } else {
+      break;
+    }
+    count++;
+    valid = ftello(fp);
+  }
+
+  /* Drop a record cut short, so that a resumed journal appends cleanly */
+  if (ftruncate(fd, valid) == -1) count = -1;
+  free(text);
+  fclose(fp);
+  return count;
+}
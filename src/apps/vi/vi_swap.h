@@ -0,0 +1,97 @@
+/** @file vi_swap.h
+ *  @brief Swap file journaling vi's unsaved edits
+ */
+
+#ifndef VI_SWAP_H
+#define VI_SWAP_H
+
+#include <stddef.h>
+
+#include "vi_buffer.h"
+
+
+/** Open swap file, private to vi_swap.c */
+typedef struct vi_swap vi_swap_t;
+
+
+/**
+ * Returns the swap file path for a file.
+ * @param path Edited file
+ * @param out Buffer for the swap path
+ * @param size Size of out
+ * @return 0 on success, -1 if the path does not fit
+ */
+int vi_swap_path(const char *path, char *out, size_t size);
+
+/**
+ * Starts a journal of the edits made to a file.
+ *
+ * The swap file (FILE.swp) starts with the identity of the file as it is
+ * on disk, followed by one record per insertion or deletion made since
+ * then. Records are queued in memory, and consecutive keystrokes that
+ * extend the same insertion share one record; vi_swap_flush() appends the
+ * queue to the file. Keeping the journal current thus costs as much as
+ * the edits themselves, not the size of the file.
+ *
+ * @param path Edited file, which may not exist yet
+ * @param resume Non-zero to append to an existing journal for the file,
+ *               as after vi_swap_recover(); zero to start a new one
+ * @return The journal, or NULL on error (errno set; EEXIST if a swap
+ *         file is already there and resume is zero)
+ */
+vi_swap_t *vi_swap_open(const char *path, int resume);
+
+/**
+ * Closes a journal.
+ * @param swap Journal; NULL is ignored
+ * @param keep Non-zero to flush the journal and leave the swap file for
+ *             recovery, zero to remove it
+ */
+void vi_swap_close(vi_swap_t *swap, int keep);
+
+/**
+ * Records an insertion.
+ * @param swap Journal; NULL is ignored
+ * @param pos Offset of the insertion
+ * @param text Text inserted
+ * @param len Length of text
+ * @return 0 on success, -1 if out of memory
+ */
+int vi_swap_insert(vi_swap_t *swap, size_t pos, const char *text,
+                   size_t len);
+
+/**
+ * Records a deletion.
+ * @param swap Journal; NULL is ignored
+ * @param pos Offset of the first byte deleted
+ * @param len Number of bytes deleted
+ * @return 0 on success, -1 if out of memory
+ */
+int vi_swap_delete(vi_swap_t *swap, size_t pos, size_t len);
+
+/**
+ * Appends the queued records to the swap file.
+ * @param swap Journal; NULL is ignored
+ * @return 0 on success, -1 on write error (errno set)
+ */
+int vi_swap_flush(vi_swap_t *swap);
+
+/**
+ * Empties the journal after the file was saved, taking the saved file
+ * as the new starting point.
+ * @param swap Journal; NULL is ignored
+ * @param path File as saved
+ * @return 0 on success, -1 on error (errno set)
+ */
+int vi_swap_reset(vi_swap_t *swap, const char *path);
+
+/**
+ * Replays the journal of a file onto a buffer holding the file.
+ * @param path Edited file
+ * @param buf Buffer loaded from path (empty if path does not exist)
+ * @return Number of edits replayed, or -1 on error (errno set; ESTALE if
+ *         the file changed after the journal was started)
+ */
+long vi_swap_recover(const char *path, vi_buffer_t *buf);
+
+#endif
@@ -0,0 +1,436 @@
+/** @file vi_undo.c
+ *  @brief Undo tree of the edits made to vi's buffer
+ *
+ * Each group is a node whose edits lead from its parent's state to its
+ * own. The groups on the path from the root to the current one are
+ * applied: their deletions hold the text cut and their insertions hold
+ * nothing. Every other group is undone, which swaps that around. Undoing
+ * or redoing a group flips each of its edits between the two.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "vi_undo.h"
+
+
+typedef enum {
+  UNDO_INSERT = 1,
+  UNDO_DELETE = 2
+} undo_op_t;
+
+/** One insertion or deletion of len bytes at pos */
+typedef struct {
+  undo_op_t op;
+  size_t pos;
+  size_t len;
+  vi_cut_t *cut;              /* The text while it is out of the buffer */
+} undo_entry_t;
+
+typedef struct undo_group {
+  unsigned long seq;          /* Order the group was made in */
+  struct undo_group *parent;
+  struct undo_group *children;  /* Newest first */
+  struct undo_group *next;    /* Next older sibling */
+  struct undo_group *redo;    /* Child redo moves to */
+  undo_entry_t *entries;
+  size_t count;
+  size_t cap;
+} undo_group_t;
+
+struct vi_undo {
+  undo_group_t *root;         /* Oldest state kept; has no entries */
+  undo_group_t *cur;          /* Group whose state the buffer is in */
+  size_t groups;              /* Groups other than the root */
+  size_t max_groups;
+  unsigned long next_seq;
+  int boundary;               /* Next edit starts a new group */
+};
+
+
+/**
+ * Frees the edits of a group.
+ */
+static void drop_entries(undo_group_t *g) {
+  for (size_t i = 0; i < g->count; i++) vi_cut_free(g->entries[i].cut);
+  free(g->entries);
+  g->entries = NULL;
+  g->count = 0;
+  g->cap = 0;
+}
+
+
+static void free_children(vi_undo_t *undo, undo_group_t *g);
+
+
+/**
+ * Frees a group and everything below it.
+ */
+static void free_group(vi_undo_t *undo, undo_group_t *g) {
+  free_children(undo, g);
+  drop_entries(g);
+  free(g);
+  undo->groups--;
+}
+
+
+/**
+ * Frees all children of a group.
+ */
+static void free_children(vi_undo_t *undo, undo_group_t *g) {
+  undo_group_t *c = g->children;
+  while (c) {
+    undo_group_t *next = c->next;
+    free_group(undo, c);
+    c = next;
+  }
+  g->children = NULL;
+  g->redo = NULL;
+}
+
+
+/**
+ * Makes room for a new group by dropping the oldest groups on the
+ * current branch, together with the branches leading off before them.
+ * At the root, every branch has been undone and all are dropped.
+ */
+static void prune(vi_undo_t *undo) {
+  while (undo->groups >= undo->max_groups && undo->root->children) {
+    if (undo->cur == undo->root) {
+      free_children(undo, undo->root);
+      break;
+    }
+
+    undo_group_t *keep = undo->cur;
+    while (keep->parent != undo->root) keep = keep->parent;
+
+    undo_group_t *c = undo->root->children;
+    while (c) {
+      undo_group_t *next = c->next;
+      if (c != keep) free_group(undo, c);
+      c = next;
+    }
+    free(undo->root);
+
+    drop_entries(keep);
+    keep->parent = NULL;
+    keep->next = NULL;
+    undo->root = keep;
+    undo->groups--;
+  }
+}
+
+
+vi_undo_t *vi_undo_new(size_t max_groups) {
+  vi_undo_t *undo = calloc(1, sizeof(*undo));
+  if (!undo) return NULL;
+  undo->root = calloc(1, sizeof(*undo->root));
+  if (!undo->root) {
+    free(undo);
+    return NULL;
+  }
+  undo->max_groups = max_groups;
+  undo->next_seq = 1;
+  undo->root->seq = undo->next_seq++;
+  undo->cur = undo->root;
+  undo->boundary = 1;
+  return undo;
+}
+
+
+void vi_undo_free(vi_undo_t *undo) {
+  if (!undo) return;
+  free_group(undo, undo->root);
+  free(undo);
+}
+
+
+void vi_undo_clear(vi_undo_t *undo) {
+  if (!undo) return;
+  undo_group_t *root = undo->root;
+  free_children(undo, root);
+  root->seq = undo->next_seq++;
+  undo->cur = root;
+  undo->boundary = 1;
+}
+
+
+void vi_undo_boundary(vi_undo_t *undo) {
+  if (undo) undo->boundary = 1;
+}
+
+
+/**
+ * Returns the last edit of the group being recorded, or NULL if the next
+ * edit starts a new group.
+ */
+static undo_entry_t *last_entry(vi_undo_t *undo) {
+  if (undo->boundary || undo->cur->count == 0) return NULL;
+  return &undo->cur->entries[undo->cur->count - 1];
+}
+
+
+/**
+ * Appends an edit to the group being recorded, starting a new group
+ * below the current one after a boundary.
+ * @return The edit, or NULL if out of memory
+ */
+static undo_entry_t *new_entry(vi_undo_t *undo) {
+  if (undo->boundary) {
+    prune(undo);
+    undo_group_t *g = calloc(1, sizeof(*g));
+    if (!g) return NULL;
+    g->seq = undo->next_seq++;
+    g->parent = undo->cur;
+    g->next = undo->cur->children;
+    undo->cur->children = g;
+    undo->cur->redo = g;
+    undo->cur = g;
+    undo->groups++;
+    undo->boundary = 0;
+  }
+
+  undo_group_t *g = undo->cur;
+  if (g->count == g->cap) {
+    size_t cap = g->cap ? g->cap * 2 : 8;
+    undo_entry_t *entries = realloc(g->entries, cap * sizeof(*entries));
+    if (!entries) return NULL;
+    g->entries = entries;
+    g->cap = cap;
+  }
+  undo_entry_t *e = &g->entries[g->count++];
+  memset(e, 0, sizeof(*e));
+  return e;
+}
+
+
+/**
+ * Removes the group being recorded after its last edit cancelled out,
+ * returning to its parent's state.
+ */
+static void drop_current(vi_undo_t *undo) {
+  undo_group_t *g = undo->cur;
+  undo_group_t *parent = g->parent;
+  parent->children = g->next;
+  parent->redo = g->next;
+  undo->cur = parent;
+  undo->boundary = 1;
+  free_group(undo, g);
+}
+
+
+int vi_undo_insert(vi_undo_t *undo, size_t pos, size_t len) {
+  if (!undo || len == 0) return 0;
+
+  /* Typing extends the insertion it follows */
+  undo_entry_t *last = last_entry(undo);
+  if (last && last->op == UNDO_INSERT && last->pos + last->len == pos) {
+    last->len += len;
+    return 0;
+  }
+
+  undo_entry_t *e = new_entry(undo);
+  if (!e) {
+    vi_undo_clear(undo);
+    return -1;
+  }
+  e->op = UNDO_INSERT;
+  e->pos = pos;
+  e->len = len;
+  return 0;
+}
+
+
+int vi_undo_delete(vi_undo_t *undo, size_t pos, vi_cut_t *cut) {
+  size_t len = vi_cut_length(cut);
+  if (!undo || len == 0) {
+    vi_cut_free(cut);
+    return 0;
+  }
+
+  undo_entry_t *last = last_entry(undo);
+  if (last && last->op == UNDO_INSERT && pos >= last->pos &&
+      pos + len == last->pos + last->len) {
+    /* Backspace takes back what was just typed */
+    vi_cut_free(cut);
+    last->len -= len;
+    if (last->len == 0 && --undo->cur->count == 0) drop_current(undo);
+    return 0;
+  }
+  if (last && last->op == UNDO_DELETE && last->pos == pos) {
+    /* Repeated x deletes at the same place */
+    last->cut = vi_cut_join(last->cut, cut);
+    last->len += len;
+    return 0;
+  }
+  if (last && last->op == UNDO_DELETE && pos + len == last->pos) {
+    /* Backspace deletes just before the last deletion */
+    last->cut = vi_cut_join(cut, last->cut);
+    last->pos = pos;
+    last->len += len;
+    return 0;
+  }
+
+  undo_entry_t *e = new_entry(undo);
+  if (!e) {
+    vi_cut_free(cut);
+    vi_undo_clear(undo);
+    return -1;
+  }
+  e->op = UNDO_DELETE;
+  e->pos = pos;
+  e->len = len;
+  e->cut = cut;
+  return 0;
+}
+
+
+/**
+ * Journals text that was put back into the buffer, a block at a time.
+ */
+static void journal_insert(vi_swap_t *swap, const vi_buffer_t *buf,
+                           size_t pos, size_t len) {
+  if (!swap) return;
+  char block[4096];
+  size_t done = 0;
+  while (done < len) {
+    size_t want = len - done < sizeof(block) ? len - done : sizeof(block);
+    size_t n = vi_buffer_read(buf, pos + done, block, want);
+    if (n == 0) break;
+    vi_swap_insert(swap, pos + done, block, n);
+    done += n;
+  }
+}
+
+
+/**
+ * Undoes or redoes the edits of a group, in reverse order for undo.
+ * @param pos Set to the offset of the last edit applied
+ * @return 0 on success, -1 if out of memory
+ */
+static int apply(undo_group_t *g, int redo, vi_buffer_t *buf,
+                 vi_swap_t *swap, size_t *pos) {
+  for (size_t k = 0; k < g->count; k++) {
+    undo_entry_t *e = &g->entries[redo ? k : g->count - 1 - k];
+    if ((e->op == UNDO_INSERT) == !!redo) {
+      if (vi_buffer_paste(buf, e->pos, e->cut) == -1) return -1;
+      e->cut = NULL;
+      journal_insert(swap, buf, e->pos, e->len);
+    } else {
+      if (vi_buffer_cut(buf, e->pos, e->len, &e->cut) == -1) return -1;
+      vi_swap_delete(swap, e->pos, e->len);
+    }
+    *pos = e->pos;
+  }
+  return 0;
+}
+
+
+/**
+ * Undoes the current group and moves to its parent.
+ */
+static int undo_one(vi_undo_t *undo, vi_buffer_t *buf, vi_swap_t *swap,
+                    size_t *pos) {
+  undo_group_t *g = undo->cur;
+  if (apply(g, 0, buf, swap, pos) == -1) return -1;
+  g->parent->redo = g;
+  undo->cur = g->parent;
+  return 0;
+}
+
+
+/**
+ * Redoes a child of the current group and moves to it.
+ */
+static int redo_one(vi_undo_t *undo, undo_group_t *g, vi_buffer_t *buf,
+                    vi_swap_t *swap, size_t *pos) {
+  if (apply(g, 1, buf, swap, pos) == -1) return -1;
+  g->parent->redo = g;
+  undo->cur = g;
+  return 0;
+}
+
+
+int vi_undo_undo(vi_undo_t *undo, vi_buffer_t *buf, vi_swap_t *swap,
+                 size_t *pos) {
+  undo->boundary = 1;
+  if (undo->cur == undo->root) return 0;
+  if (undo_one(undo, buf, swap, pos) == -1) {
+    vi_undo_clear(undo);
+    return -1;
+  }
+  return 1;
+}
+
+
+int vi_undo_redo(vi_undo_t *undo, vi_buffer_t *buf, vi_swap_t *swap,
+                 size_t *pos) {
+  undo->boundary = 1;
+  if (!undo->cur->redo) return 0;
+  if (redo_one(undo, undo->cur->redo, buf, swap, pos) == -1) {
+    vi_undo_clear(undo);
+    return -1;
+  }
+  return 1;
+}
+
+
+/**
+ * Finds the group made last before seq (dir < 0) or first after it.
+ */
+static undo_group_t *find_step(undo_group_t *g, unsigned long seq, int dir,
+                               undo_group_t *best) {
+  for (; g; g = g->next) {
+    if (dir < 0 ? g->seq < seq && (!best || g->seq > best->seq)
+                : g->seq > seq && (!best || g->seq < best->seq)) {
+      best = g;
+    }
+    best = find_step(g->children, seq, dir, best);
+  }
+  return best;
+}
+
+
+/**
+ * Returns the number of groups above g.
+ */
+static size_t depth(const undo_group_t *g) {
+  size_t d = 0;
+  while ((g = g->parent)) d++;
+  return d;
+}
+
+
+int vi_undo_step(vi_undo_t *undo, int dir, vi_buffer_t *buf,
+                 vi_swap_t *swap, size_t *pos) {
+  undo->boundary = 1;
+  undo_group_t *target = find_step(undo->root, undo->cur->seq, dir, NULL);
+  if (!target) return 0;
+
+  /* Undo up to where the branches meet, then redo down to the target */
+  undo_group_t *a = undo->cur, *b = target;
+  size_t da = depth(a), db = depth(b);
+  for (; da > db; da--) a = a->parent;
+  for (; db > da; db--) b = b->parent;
+  while (a != b) {
+    a = a->parent;
+    b = b->parent;
+  }
+  while (undo->cur != a) {
+    if (undo_one(undo, buf, swap, pos) == -1) goto fail;
+  }
+  for (undo_group_t *g = target; g != a; g = g->parent) g->parent->redo = g;
+  while (undo->cur != target) {
+    if (redo_one(undo, undo->cur->redo, buf, swap, pos) == -1) goto fail;
+  }
+  return 1;
+
+fail:
+  vi_undo_clear(undo);
+  return -1;
+}
+
+
+unsigned long vi_undo_seq(const vi_undo_t *undo) {
+  return undo->cur->seq;
+}
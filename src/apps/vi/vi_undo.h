@@ -0,0 +1,124 @@
+/** @file vi_undo.h
+ *  @brief Undo tree of the edits made to vi's buffer
+ */
+
+#ifndef VI_UNDO_H
+#define VI_UNDO_H
+
+#include <stddef.h>
+
+#include "vi_buffer.h"
+#include "vi_swap.h"
+
+
+/** Edit history, private to vi_undo.c */
+typedef struct vi_undo vi_undo_t;
+
+
+/**
+ * Creates an empty history.
+ *
+ * Edits are recorded as insertions and deletions at byte offsets, in
+ * groups that are undone and redone as one; vi_undo_boundary() starts
+ * the next group. A deletion keeps the pieces it cut out of the buffer
+ * (see vi_buffer_cut()) and an undone insertion keeps the pieces it
+ * removed, so undoing or redoing moves pieces back and forth instead of
+ * copying text, and costs O(log n) per edit in the group. Consecutive
+ * keystrokes that extend the same insertion or deletion share one edit.
+ *
+ * Editing after an undo starts a new branch rather than discarding the
+ * undone groups, so the history is a tree; vi_undo_step() walks all of
+ * it in the order the groups were made.
+ *
+ * @param max_groups Groups kept; the oldest are dropped beyond this
+ * @return The history, or NULL if out of memory
+ */
+vi_undo_t *vi_undo_new(size_t max_groups);
+
+/**
+ * Frees a history.
+ * @param undo History; NULL is ignored
+ */
+void vi_undo_free(vi_undo_t *undo);
+
+/**
+ * Forgets all edits. Must be called when the buffer is loaded again,
+ * since the edits refer to its old contents.
+ * @param undo History; NULL is ignored
+ */
+void vi_undo_clear(vi_undo_t *undo);
+
+/**
+ * Ends the current group, so that the next edit starts another.
+ * @param undo History; NULL is ignored
+ */
+void vi_undo_boundary(vi_undo_t *undo);
+
+/**
+ * Records an insertion just made.
+ * @param undo History; NULL is ignored
+ * @param pos Offset of the insertion
+ * @param len Length of the text inserted
+ * @return 0 on success, -1 if out of memory (the history is cleared)
+ */
+int vi_undo_insert(vi_undo_t *undo, size_t pos, size_t len);
+
+/**
+ * Records a deletion just made.
+ * @param undo History; if NULL, cut is freed
+ * @param pos Offset of the first byte deleted
+ * @param cut Text deleted, from vi_buffer_cut(); the history takes it
+ *            over in every case
+ * @return 0 on success, -1 if out of memory (the history is cleared)
+ */
+int vi_undo_delete(vi_undo_t *undo, size_t pos, vi_cut_t *cut);
+
+/**
+ * Undoes the current group.
+ * @param undo History
+ * @param buf Buffer the edits were made to
+ * @param swap Journal to record the changes in; NULL for none
+ * @param pos Set to the offset of the last edit undone or redone
+ * @return 1 if a group was undone, 0 if there is none, -1 if out of
+ *         memory (the history is cleared)
+ */
+int vi_undo_undo(vi_undo_t *undo, vi_buffer_t *buf, vi_swap_t *swap,
+                 size_t *pos);
+
+/**
+ * Redoes the group undone last on the current branch.
+ * @param undo History
+ * @param buf Buffer the edits were made to
+ * @param swap Journal to record the changes in; NULL for none
+ * @param pos Set to the offset of the last edit undone or redone
+ * @return 1 if a group was redone, 0 if there is none, -1 if out of
+ *         memory (the history is cleared)
+ */
+int vi_undo_redo(vi_undo_t *undo, vi_buffer_t *buf, vi_swap_t *swap,
+                 size_t *pos);
+
+/**
+ * Moves to the state before or after the current one in time, across
+ * branches, undoing and redoing the groups between them.
+ * @param undo History
+ * @param dir -1 for the older state, 1 for the newer
+ * @param buf Buffer the edits were made to
+ * @param swap Journal to record the changes in; NULL for none
+ * @param pos Set to the offset of the last edit undone or redone
+ * @return 1 if moved, 0 if there is no such state, -1 if out of memory
+ *         (the history is cleared)
+ */
+int vi_undo_step(vi_undo_t *undo, int dir, vi_buffer_t *buf,
+                 vi_swap_t *swap, size_t *pos);
+
+/**
+ * Returns a number naming the current state of the text. It changes
+ * with every group made, undone or redone, and comes back when an undo
+ * returns to an earlier state, so comparing it with its value when the
+ * file was saved tells whether the text is modified.
+ * @param undo History
+ * @return State number, never 0
+ */
+unsigned long vi_undo_seq(const vi_undo_t *undo);
+
+#endif
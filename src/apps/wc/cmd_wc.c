@@ -0,0 +1,602 @@
+/**
+ * @file cmd_wc.c
+ * @brief Wc command implementation for jshell.
+ *
+ * Lines are counted with jbox_linereader_count(), eight bytes per step.
+ * Words are counted the same way: each step sets the top bit of every
+ * whitespace byte, and a word starts at each byte without it whose
+ * previous byte has it: ~space & (space << 8), with the last byte carried
+ * into the next step. Those bits go into per-byte counters summed every
+ * 255 steps.
+ * Regular files are mapped whole; pipes and terminals are read in large
+ * blocks. A byte count alone is fstat(), without reading anything.
+ * Several files are counted at once on a pool of threads.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "argtable3.h"
+#include "jshell/jshell_cmd_registry.h"
+#include "utils/jbox_ctx.h"
+#include "utils/jbox_json.h"
+#include "utils/jbox_linereader.h"
+#include "utils/jbox_signals.h"
+
+
+/** Block size for files that cannot be mapped */
+#define WC_BLOCK (256 * 1024)
+
+/** Mapped files are counted in slices of this size, so an interrupt is
+ *  noticed and pages already counted can be dropped */
+#define WC_SLICE (16 * 1024 * 1024)
+
+/** Text is counted in pieces of this size, which stay in cache between
+ *  the line and word passes */
+#define WC_PIECE (32 * 1024)
+
+/** Upper bound on counting threads */
+#define WC_MAX_WORKERS 16
+
+/** Eight copies of a byte value */
+#define BYTES8(b) (0x0101010101010101ULL * (uint64_t)(b))
+
+
+/** What to count */
+typedef struct {
+  int lines;
+  int words;
+  int bytes;
+} wc_fields_t;
+
+/** Counts of one file */
+typedef struct {
+  const char *name;         /* As given; "-" for standard input */
+  long long lines;
+  long long words;
+  long long bytes;
+  int err;                  /* errno of a failure, or 0 */
+  int interrupted;
+} wc_counts_t;
+
+/** Files shared by the counting threads */
+typedef struct {
+  wc_counts_t *files;
+  size_t count;
+  atomic_size_t next;
+  wc_fields_t fields;
+  jbox_ctx_t *ctx;
+} wc_pool_t;
+
+
+typedef struct {
+  struct arg_lit *help;
+  struct arg_lit *lines;
+  struct arg_lit *words;
+  struct arg_lit *bytes;
+  struct arg_lit *json;
+  struct arg_file *files;
+  struct arg_end *end;
+  void *argtable[7];
+} wc_args_t;
+
+
+/**
+ * Build the argument table for the wc command.
+ * @param args Pointer to wc_args_t structure to populate.
+ */
+static void build_wc_argtable(wc_args_t *args) {
+  args->help  = arg_lit0("h", "help", "display this help and exit");
+  args->lines = arg_lit0("l", "lines", "print the newline counts");
+  args->words = arg_lit0("w", "words", "print the word counts");
+  args->bytes = arg_lit0("c", "bytes", "print the byte counts");
+  args->json  = arg_lit0(NULL, "json", "output in JSON format");
+  args->files = arg_filen(NULL, NULL, "FILE", 0, 1000,
+                          "files to count (default: standard input)");
+  args->end   = arg_end(20);
+
+  args->argtable[0] = args->help;
+  args->argtable[1] = args->lines;
+  args->argtable[2] = args->words;
+  args->argtable[3] = args->bytes;
+  args->argtable[4] = args->json;
+  args->argtable[5] = args->files;
+  args->argtable[6] = args->end;
+}
+
+
+/**
+ * Clean up and free the argument table.
+ * @param args Pointer to wc_args_t structure to clean up.
+ */
+static void cleanup_wc_argtable(wc_args_t *args) {
+  arg_freetable(args->argtable,
+                sizeof(args->argtable) / sizeof(args->argtable[0]));
+}
+
+
+/**
+ * Print usage information for the wc command.
+ * @param out Output stream to write usage information to.
+ */
+static void wc_print_usage(FILE *out) {
+  wc_args_t args;
+  build_wc_argtable(&args);
+  fprintf(out, "Usage: wc");
+  arg_print_syntax(out, args.argtable, "\n");
+  fprintf(out, "Print newline, word and byte counts for each FILE, and a "
+               "total if more than one.\n\n");
+  fprintf(out, "Options:\n");
+  arg_print_glossary(out, args.argtable, "  %-20s %s\n");
+  cleanup_wc_argtable(&args);
+}
+
+
+/**
+ * Passes the wc argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void wc_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  wc_args_t args;
+  build_wc_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_wc_argtable(&args);
+}
+
+
+/**
+ * Tells the result cache what the output of wc depends on: the named files;
+ * not when reading stdin.
+ *
+ * @param argc Number of arguments
+ * @param argv Array of argument strings
+ * @return How this run may be cached
+ */
+static jshell_cmd_cache_t wc_cache_scope(int argc, char **argv) {
+  wc_args_t args;
+  build_wc_argtable(&args);
+  int nerrors = arg_parse(argc, argv, args.argtable);
+  jshell_cmd_cache_t scope = CMD_CACHE_NONE;
+  if (nerrors == 0 && args.help->count == 0
+      && args.files->count > 0) {
+    scope = CMD_CACHE_FILES;
+  }
+  cleanup_wc_argtable(&args);
+  return scope;
+}
+
+
+/**
+ * Mask of the whitespace bytes of a word: the top bit of each byte that
+ * is ' ', '\t', '\n', '\v', '\f' or '\r'.
+ */
+static inline uint64_t space_mask(uint64_t word) {
+  const uint64_t high = BYTES8(0x80);
+  const uint64_t low7 = BYTES8(0x7f);
+
+  /* Bytes equal to ' ', by the exact zero-byte test */
+  uint64_t x = word ^ BYTES8(' ');
+  uint64_t blank = ~(((x & low7) + low7) | x | low7);
+
+  /* Bytes in '\t'..'\r': at least 9 and not at least 14, among bytes
+   * below 0x80; adding to the low seven bits never carries out */
+  uint64_t t = word & low7;
+  uint64_t ge9 = t + BYTES8(0x80 - 9);
+  uint64_t ge14 = t + BYTES8(0x80 - 14);
+  uint64_t control = ge9 & ~ge14 & ~word & high;
+
+  return blank | control;
+}
+
+
+/**
+ * Adds up the eight byte lanes of a word.
+ */
+static inline long long sum_bytes(uint64_t acc) {
+  uint64_t pairs = (acc & 0x00ff00ff00ff00ffULL) +
+                   ((acc >> 8) & 0x00ff00ff00ff00ffULL);
+  return (long long)((pairs * 0x0001000100010001ULL) >> 48);
+}
+
+
+/**
+ * Counts words in text continuing from earlier text.
+ * @param data Text
+ * @param len Length of the text
+ * @param in_space Whether the byte before the text was whitespace (1 at
+ *        the start of a file); updated to the last byte of the text
+ * @return Number of words starting in the text
+ */
+static long long count_words(const unsigned char *data, size_t len,
+                             int *in_space) {
+  const uint64_t high = BYTES8(0x80);
+  long long words = 0;
+  uint64_t carry = *in_space ? 0x80 : 0;
+
+  while (len >= 8) {
+    /* Each byte of acc counts the words starting in its lane, for at
+     * most 255 steps so it cannot overflow */
+    size_t steps = len / 8 < 255 ? len / 8 : 255;
+    uint64_t acc = 0;
+    for (size_t i = 0; i < steps; i++) {
+      uint64_t word;
+      memcpy(&word, data, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+      word = __builtin_bswap64(word);   /* Byte 0 lowest */
+#endif
+      uint64_t space = space_mask(word);
+      /* The top bit of each byte moved up to the byte after it */
+      uint64_t before = (space << 8) | carry;
+      acc += (~space & before & high) >> 7;
+      carry = space >> 56;
+      data += 8;
+    }
+    len -= steps * 8;
+    words += sum_bytes(acc);
+  }
+
+  while (len > 0) {
+    unsigned char c = *data++;
+    uint64_t space = c == ' ' || (c >= '\t' && c <= '\r') ? 0x80 : 0;
+    words += !space && carry;
+    carry = space;
+    len--;
+  }
+
+  *in_space = carry != 0;
+  return words;
+}
+
+
+/**
+ * Counts lines and words of a block of text, a cache-sized piece at a
+ * time so the second pass reads what the first just loaded.
+ */
+static void count_block(wc_counts_t *counts, const wc_fields_t *fields,
+                        const char *data, size_t len, int *in_space) {
+  counts->bytes += (long long)len;
+  while (len > 0) {
+    size_t n = len < WC_PIECE ? len : WC_PIECE;
+    if (fields->lines) {
+      counts->lines += (long long)jbox_linereader_count(data, n);
+    }
+    if (fields->words) {
+      counts->words += count_words((const unsigned char *)data, n, in_space);
+    }
+    data += n;
+    len -= n;
+  }
+}
+
+
+/**
+ * Counts a mapped regular file, a slice at a time.
+ * @return 0 on success, -1 if it cannot be mapped, -2 on interrupt.
+ */
+static int count_mapped(int fd, size_t size, wc_counts_t *counts,
+                        const wc_fields_t *fields) {
+  char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) return -1;
+  madvise(map, size, MADV_SEQUENTIAL);
+
+  int in_space = 1;
+  for (size_t off = 0; off < size; off += WC_SLICE) {
+    if (jbox_is_interrupted()) {
+      munmap(map, size);
+      return -2;
+    }
+    size_t len = size - off < WC_SLICE ? size - off : WC_SLICE;
+    count_block(counts, fields, map + off, len, &in_space);
+    madvise(map + off, len, MADV_DONTNEED);
+  }
+  munmap(map, size);
+  return 0;
+}
+
+
+/**
+ * Counts whatever can be read from a descriptor.
+ * @return 0 on success, -1 on read error (errno set), -2 on interrupt.
+ */
+static int count_stream(int fd, wc_counts_t *counts,
+                        const wc_fields_t *fields) {
+  char *buf = malloc(WC_BLOCK);
+  if (!buf) return -1;
+
+  int in_space = 1;
+  int rc = 0;
+  for (;;) {
+    if (jbox_is_interrupted()) {
+      rc = -2;
+      break;
+    }
+    ssize_t n = read(fd, buf, WC_BLOCK);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      rc = -1;
+      break;
+    }
+    if (n == 0) break;
+    count_block(counts, fields, buf, (size_t)n, &in_space);
+  }
+
+  int saved = errno;
+  free(buf);
+  errno = saved;
+  return rc;
+}
+
+
+/**
+ * Counts one file, or standard input for "-".
+ * @param counts Its name, and set to its counts or error.
+ * @param fields What to count.
+ */
+static void count_file(wc_counts_t *counts, const wc_fields_t *fields) {
+  int is_stdin = strcmp(counts->name, "-") == 0;
+  int fd = is_stdin ? STDIN_FILENO
+                    : openat(jbox_cwd_fd(), counts->name,
+                             O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    counts->err = errno;
+    return;
+  }
+
+  int rc = 0;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    rc = -1;
+  } else if (S_ISREG(st.st_mode) && st.st_size > 0 &&
+             (!is_stdin || lseek(fd, 0, SEEK_CUR) == 0)) {
+    if (!fields->lines && !fields->words) {
+      counts->bytes = (long long)st.st_size;
+    } else {
+      rc = count_mapped(fd, (size_t)st.st_size, counts, fields);
+      if (rc == -1) rc = count_stream(fd, counts, fields);
+    }
+  } else if (S_ISDIR(st.st_mode)) {
+    errno = EISDIR;
+    rc = -1;
+  } else {
+    rc = count_stream(fd, counts, fields);
+  }
+
+  if (rc == -1) counts->err = errno;
+  if (rc == -2) counts->interrupted = 1;
+  if (!is_stdin) close(fd);
+}
+
+
+/**
+ * Takes files off the shared list until none are left.
+ * @param arg The wc_pool_t.
+ * @return NULL
+ */
+static void *wc_worker(void *arg) {
+  wc_pool_t *pool = arg;
+  jbox_ctx_adopt(pool->ctx);
+
+  for (;;) {
+    size_t i = atomic_fetch_add(&pool->next, 1);
+    if (i >= pool->count) break;
+    count_file(&pool->files[i], &pool->fields);
+  }
+  return NULL;
+}
+
+
+/**
+ * Counts every file, on as many threads as there are cores and files.
+ * @param pool Files and fields.
+ */
+static void count_all(wc_pool_t *pool) {
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int worker_count = cores > 0 ? (int)cores : 1;
+  if (worker_count > WC_MAX_WORKERS) worker_count = WC_MAX_WORKERS;
+  if ((size_t)worker_count > pool->count) worker_count = (int)pool->count;
+
+  /* The calling thread counts too */
+  pthread_t threads[WC_MAX_WORKERS];
+  int started = 0;
+  for (int i = 1; i < worker_count; i++) {
+    if (pthread_create(&threads[started], NULL, wc_worker, pool) != 0) break;
+    started++;
+  }
+  wc_worker(pool);
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+}
+
+
+/**
+ * Number of decimal digits in a count.
+ */
+static int digits(long long n) {
+  int d = 1;
+  while (n >= 10) {
+    n /= 10;
+    d++;
+  }
+  return d;
+}
+
+
+/**
+ * Print one row of counts, right-aligned to width.
+ */
+static void print_counts(const wc_counts_t *c, const wc_fields_t *fields,
+                         int width, int named) {
+  const char *sep = "";
+  if (fields->lines) {
+    jbox_printf("%s%*lld", sep, width, c->lines);
+    sep = " ";
+  }
+  if (fields->words) {
+    jbox_printf("%s%*lld", sep, width, c->words);
+    sep = " ";
+  }
+  if (fields->bytes) {
+    jbox_printf("%s%*lld", sep, width, c->bytes);
+  }
+  if (named) {
+    jbox_printf(" %s", c->name);
+  }
+  jbox_printf("\n");
+}
+
+
+/**
+ * Print one file's counts as a JSON object.
+ */
+static void print_counts_json(const wc_counts_t *c, const wc_fields_t *fields) {
+  fputs("{\"path\": ", jbox_stdout());
+  jbox_json_write_string(jbox_stdout(), c->name);
+  if (fields->lines) jbox_printf(", \"lines\": %lld", c->lines);
+  if (fields->words) jbox_printf(", \"words\": %lld", c->words);
+  if (fields->bytes) jbox_printf(", \"bytes\": %lld", c->bytes);
+  jbox_printf("}");
+}
+
+
+/**
+ * Main entry point for the wc command.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return Exit status (0 on success, 1 on error, 130 on interrupt).
+ */
+static int wc_run(int argc, char **argv) {
+  wc_args_t args;
+  build_wc_argtable(&args);
+
+  jbox_setup_sigint_handler();
+
+  int nerrors = arg_parse(argc, argv, args.argtable);
+
+  if (args.help->count > 0) {
+    wc_print_usage(jbox_stdout());
+    cleanup_wc_argtable(&args);
+    return 0;
+  }
+
+  if (nerrors > 0) {
+    arg_print_errors(stderr, args.end, "wc");
+    fprintf(stderr, "Try 'wc --help' for more information.\n");
+    cleanup_wc_argtable(&args);
+    return 1;
+  }
+
+  wc_fields_t fields = {
+    .lines = args.lines->count > 0,
+    .words = args.words->count > 0,
+    .bytes = args.bytes->count > 0,
+  };
+  if (!fields.lines && !fields.words && !fields.bytes) {
+    fields.lines = fields.words = fields.bytes = 1;
+  }
+
+  int named = args.files->count > 0;
+  size_t count = named ? (size_t)args.files->count : 1;
+  wc_counts_t *files = calloc(count, sizeof(wc_counts_t));
+  if (!files) {
+    fprintf(stderr, "wc: out of memory\n");
+    cleanup_wc_argtable(&args);
+    return 1;
+  }
+  for (size_t i = 0; i < count; i++) {
+    files[i].name = named ? args.files->filename[i] : "-";
+  }
+
+  wc_pool_t pool = {
+    .files = files,
+    .count = count,
+    .fields = fields,
+    .ctx = jbox_ctx_current(),
+  };
+  atomic_init(&pool.next, 0);
+  count_all(&pool);
+
+  wc_counts_t total = { .name = "total" };
+  int status = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (files[i].interrupted) status = 130;   /* 128 + SIGINT(2) */
+    if (files[i].err) {
+      fprintf(stderr, "wc: %s: %s\n", files[i].name,
+              strerror(files[i].err));
+      if (status == 0) status = 1;
+      continue;
+    }
+    total.lines += files[i].lines;
+    total.words += files[i].words;
+    total.bytes += files[i].bytes;
+  }
+
+  if (status != 130) {
+    if (args.json->count > 0) {
+      jbox_printf("[\n");
+      int first = 1;
+      for (size_t i = 0; i < count; i++) {
+        if (files[i].err) continue;
+        fputs(first ? "  " : ",\n  ", jbox_stdout());
+        first = 0;
+        print_counts_json(&files[i], &fields);
+      }
+      jbox_printf(first ? "]\n" : "\n]\n");
+    } else {
+      /* Columns as wide as the largest count, which is in the total */
+      long long widest = total.lines > total.words ? total.lines : total.words;
+      if (total.bytes > widest) widest = total.bytes;
+      int width = fields.lines + fields.words + fields.bytes > 1 || count > 1
+                  ? digits(widest) : 1;
+      for (size_t i = 0; i < count; i++) {
+        if (!files[i].err) print_counts(&files[i], &fields, width, named);
+      }
+      if (count > 1) print_counts(&total, &fields, width, 1);
+    }
+  }
+
+  fflush(jbox_stdout());
+  free(files);
+  cleanup_wc_argtable(&args);
+  return status;
+}
+
+
+/**
+ * Command specification for wc command.
+ */
+const jshell_cmd_spec_t cmd_wc_spec = {
+  .name = "wc",
+  .summary = "count lines, words and bytes",
+  .long_help = "Print newline, word and byte counts for each FILE (or "
+               "standard input), and a total when there are several. "
+               "-l, -w and -c select counts; a byte count alone is taken "
+               "from the file size without reading. Several files are "
+               "counted in parallel. --json prints an array of objects.",
+  .type = CMD_EXTERNAL,
+  .run = wc_run,
+  .print_usage = wc_print_usage,
+  .describe_args = wc_describe_args,
+  .cache_scope = wc_cache_scope
+};
+
+
+/**
+ * Registers the wc command with the shell command registry.
+ */
+void jshell_register_wc_command(void) {
+  jshell_register_command(&cmd_wc_spec);
+}
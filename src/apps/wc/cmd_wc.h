@@ -0,0 +1,10 @@
+#ifndef CMD_WC_H
+#define CMD_WC_H
+
+#include "jshell/jshell_cmd_registry.h"
+
+extern const jshell_cmd_spec_t cmd_wc_spec;
+
+void jshell_register_wc_command(void);
+
+#endif
@@ -0,0 +1,17 @@
+/**
+ * @file wc_main.c
+ * @brief Main entry point for standalone wc command.
+ */
+
+#include "cmd_wc.h"
+
+
+/**
+ * Main entry point for standalone wc binary.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return Exit status from wc_run.
+ */
+int main(int argc, char **argv) {
+  return cmd_wc_spec.run(argc, argv);
+}
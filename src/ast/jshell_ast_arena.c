@@ -0,0 +1,165 @@
+/**
+ * @file jshell_ast_arena.c
+ * @brief Bump arena behind the generated BNFC parser's allocations.
+ *
+ * A parsed line is a few dozen small nodes and token strings that all
+ * die together once the plan is built. Allocating them one by one with
+ * malloc() and walking the tree again in free_Input() is pure overhead;
+ * from an arena they are a pointer bump each and a single reset at the
+ * end. See jshell_ast_arena.h for how the generated code is hooked.
+ */
+
+#include <stdalign.h>
+#include <stdint.h>
+
+#include "jshell_ast_arena.h"
+
+
+/** Chunk size; one chunk covers any ordinary command line */
+#define AST_ARENA_CHUNK_SIZE (16 * 1024)
+
+
+struct JShellAstChunk {
+  JShellAstChunk* next;
+  size_t size;
+  size_t used;
+  alignas(max_align_t) unsigned char data[];
+};
+
+
+/** Arena the hooks allocate from on this thread, or NULL */
+static thread_local JShellAstArena* t_current_arena = NULL;
+
+
+/**
+ * Make an arena current on this thread.
+ * @param arena Arena to allocate parse trees from.
+ * @return The previously current arena, for jshell_ast_arena_end().
+ */
+JShellAstArena* jshell_ast_arena_begin(JShellAstArena* arena) {
+  JShellAstArena* previous = t_current_arena;
+  t_current_arena = arena;
+  return previous;
+}
+
+
+/**
+ * Stop allocating from the current arena.
+ * @param previous Arena returned by the matching jshell_ast_arena_begin().
+ */
+void jshell_ast_arena_end(JShellAstArena* previous) {
+  t_current_arena = previous;
+}
+
+
+/**
+ * Release everything allocated from an arena. The newest chunk is kept
+ * (emptied) when it has the default size, so the next line allocates
+ * nothing from the system; oversized chunks from huge lines are freed.
+ * @param arena Arena to reset.
+ */
+void jshell_ast_arena_reset(JShellAstArena* arena) {
+  JShellAstChunk* keep = arena->chunks;
+  if (keep != NULL && keep->size != AST_ARENA_CHUNK_SIZE) {
+    keep = NULL;
+  }
+
+  JShellAstChunk* chunk = arena->chunks;
+  while (chunk != NULL) {
+    JShellAstChunk* next = chunk->next;
+    if (chunk != keep) {
+      free(chunk);
+    }
+    chunk = next;
+  }
+
+  if (keep != NULL) {
+    keep->next = NULL;
+    keep->used = 0;
+  }
+  arena->chunks = keep;
+}
+
+
+/**
+ * Release all memory of an arena.
+ * @param arena Arena to destroy; it is left empty and reusable.
+ */
+void jshell_ast_arena_destroy(JShellAstArena* arena) {
+  jshell_ast_arena_reset(arena);
+  free(arena->chunks);
+  arena->chunks = NULL;
+}
+
+
+/**
+ * Allocate from the current arena, or with malloc() if there is none.
+ * @param size Bytes needed.
+ * @return Memory aligned like malloc()'s, or NULL if memory ran out.
+ */
+void* jshell_ast_alloc(size_t size) {
+  JShellAstArena* arena = t_current_arena;
+  if (arena == NULL) {
+    return malloc(size);
+  }
+
+  const size_t align = alignof(max_align_t);
+  size = (size + align - 1) & ~(align - 1);
+
+  JShellAstChunk* chunk = arena->chunks;
+  if (chunk == NULL || chunk->size - chunk->used < size) {
+    size_t chunk_size = size > AST_ARENA_CHUNK_SIZE ? size
+                                                    : AST_ARENA_CHUNK_SIZE;
+    chunk = malloc(sizeof(JShellAstChunk) + chunk_size);
+    if (chunk == NULL) {
+      return NULL;
+    }
+    chunk->size = chunk_size;
+    chunk->used = 0;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+  }
+
+  void* ptr = chunk->data + chunk->used;
+  chunk->used += size;
+  return ptr;
+}
+
+
+/**
+ * Copy a token string into the current arena.
+ * @param text String to copy.
+ * @return The copy, or NULL if memory ran out.
+ */
+char* jshell_ast_strdup(const char* text) {
+  size_t len = strlen(text) + 1;
+  char* copy = jshell_ast_alloc(len);
+  if (copy != NULL) {
+    memcpy(copy, text, len);
+  }
+  return copy;
+}
+
+
+/**
+ * Free memory from jshell_ast_alloc(). Memory of the current arena is
+ * left to the reset; anything else came from malloc().
+ * @param ptr Memory to free, or NULL.
+ */
+void jshell_ast_free(void* ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+
+  JShellAstArena* arena = t_current_arena;
+  if (arena != NULL) {
+    uintptr_t p = (uintptr_t)ptr;
+    for (JShellAstChunk* c = arena->chunks; c != NULL; c = c->next) {
+      uintptr_t start = (uintptr_t)c->data;
+      if (p >= start && p < start + c->size) {
+        return;
+      }
+    }
+  }
+  free(ptr);
+}
@@ -0,0 +1,57 @@
+#ifndef JSHELL_AST_ARENA_H
+#define JSHELL_AST_ARENA_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// Bump arena for BNFC parse trees. The bnfc make target includes this
+// header at the top of the generated Absyn.c (nodes) and Lexer.c (token
+// text), so while an arena is current on the calling thread a whole tree
+// is carved out of a few large chunks and dropped with one reset instead
+// of free_Input() walking and freeing every node. With no current arena
+// the hooks fall back to malloc()/free(), so trees built outside one are
+// still released with free_Input()
+typedef struct JShellAstChunk JShellAstChunk;
+
+typedef struct {
+  JShellAstChunk* chunks;   // Newest first; the head is being filled
+} JShellAstArena;
+
+
+// Make arena current on this thread; returns the previously current arena
+JShellAstArena* jshell_ast_arena_begin(JShellAstArena* arena);
+
+// Stop allocating from the current arena and make previous current again
+void jshell_ast_arena_end(JShellAstArena* previous);
+
+// Release everything allocated from arena, keeping one chunk for reuse
+// Trees built in it must not be used or passed to free_Input() afterwards
+void jshell_ast_arena_reset(JShellAstArena* arena);
+
+// Release arena's memory entirely
+void jshell_ast_arena_destroy(JShellAstArena* arena);
+
+// Allocation hooks called from the generated parser sources
+void* jshell_ast_alloc(size_t size);
+char* jshell_ast_strdup(const char* text);
+void jshell_ast_free(void* ptr);
+
+
+// Redirect the generated code's allocations. Absyn.c is built with
+// JSHELL_AST_ARENA_NODES defined; Lexer.c only has its token strdup()
+// redirected, since flex's own buffers are realloc()ed
+#ifdef JSHELL_AST_ARENA_HOOK
+#undef strdup
+#undef free
+#define strdup(text) jshell_ast_strdup(text)
+#define free(ptr) jshell_ast_free(ptr)
+#ifdef JSHELL_AST_ARENA_NODES
+#undef malloc
+#define malloc(size) jshell_ast_alloc(size)
+#endif
+#endif
+
+
+#endif
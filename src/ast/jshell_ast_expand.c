@@ -0,0 +1,535 @@
+/**
+ * @file jshell_ast_expand.c
+ * @brief Native shell word expansion.
+ *
+ * Expands the common cases of a shell word directly: quote removal,
+ * $NAME, ${NAME} and $? from the shell variables, leading ~, field splitting
+ * on IFS and pathname globbing. Results are copied into a per-command
+ * arena, so expanding a command costs a few chunk allocations instead of
+ * one per word. Constructs this file does not handle (positional and
+ * special parameters, ${...} operators, arithmetic, ~user, unquoted shell
+ * metacharacters) fall back to wordexp(), which also reports its errors.
+ * There is no brace expansion, so '{' and '}' are ordinary characters.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <glob.h>
+#include <wordexp.h>
+
+#include "utils/jbox_utils.h"
+#include "jshell/jshell.h"
+#include "jshell/jshell_vars.h"
+
+#include "jshell_ast_expand.h"
+
+
+/** Returned by the native expander for constructs it leaves to wordexp */
+#define EXPAND_UNSUPPORTED (-1)
+
+/** Characters that send a word down the slow path */
+#define EXPAND_SPECIAL_CHARS "\\'\"$~*?[`|&;<>()\n"
+
+
+struct JShellArenaChunk {
+  JShellArenaChunk* next;
+  size_t used;
+  size_t size;
+  char data[];
+};
+
+
+/** The field currently being built; glob characters that came from quotes
+ *  are stored backslash-escaped so the field can be used as a pattern */
+typedef struct {
+  char* data;
+  size_t len;
+  size_t cap;
+  bool started;    /* A field exists even if empty, e.g. "" */
+  bool has_glob;   /* Contains an unquoted glob metacharacter */
+  char inline_data[EXPAND_FIELD_INLINE_SIZE];
+} ExpandField;
+
+
+/**
+ * Allocate bytes from an arena.
+ * @param arena Arena to allocate from.
+ * @param size Bytes needed.
+ * @return Pointer to the bytes, or NULL on allocation failure.
+ */
+static char* arena_alloc(JShellArena* arena, size_t size) {
+  JShellArenaChunk* chunk = arena->head;
+
+  if (chunk == NULL || chunk->size - chunk->used < size) {
+    size_t chunk_size = (size > EXPAND_ARENA_CHUNK_SIZE)
+                        ? size : EXPAND_ARENA_CHUNK_SIZE;
+    chunk = malloc(sizeof(JShellArenaChunk) + chunk_size);
+    if (chunk == NULL) {
+      return NULL;
+    }
+    chunk->next = arena->head;
+    chunk->used = 0;
+    chunk->size = chunk_size;
+    arena->head = chunk;
+  }
+
+  char* ptr = chunk->data + chunk->used;
+  chunk->used += size;
+  return ptr;
+}
+
+
+/**
+ * Append a word to the list, copying its text into the arena.
+ * @param words Word list.
+ * @param text Word text (need not be terminated).
+ * @param len Length of text.
+ * @param unescape Drop the backslashes that escape pattern characters.
+ * @return 0 on success, WRDE_NOSPACE on allocation failure.
+ */
+static int words_push(JShellWords* words, const char* text, size_t len,
+                      bool unescape) {
+  if (words->wordc + 2 > words->wordv_cap) {
+    size_t new_cap = (words->wordv_cap == 0) ? 8 : words->wordv_cap * 2;
+    char** grown = realloc(words->wordv, new_cap * sizeof(char*));
+    if (grown == NULL) {
+      return WRDE_NOSPACE;
+    }
+    words->wordv = grown;
+    words->wordv_cap = new_cap;
+  }
+
+  char* copy = arena_alloc(&words->arena, len + 1);
+  if (copy == NULL) {
+    return WRDE_NOSPACE;
+  }
+
+  size_t out = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (unescape && text[i] == '\\' && i + 1 < len) {
+      i++;
+    }
+    copy[out++] = text[i];
+  }
+  copy[out] = '\0';
+
+  words->wordv[words->wordc++] = copy;
+  words->wordv[words->wordc] = NULL;
+  return 0;
+}
+
+
+/**
+ * Append one byte to the field being built.
+ * @param f Field.
+ * @param c Byte to append.
+ * @return 0 on success, WRDE_NOSPACE on allocation failure.
+ */
+static int field_putc(ExpandField* f, char c) {
+  if (f->len + 1 >= f->cap) {
+    size_t new_cap = f->cap * 2;
+    char* grown;
+    if (f->data == f->inline_data) {
+      grown = malloc(new_cap);
+      if (grown != NULL) {
+        memcpy(grown, f->data, f->len);
+      }
+    } else {
+      grown = realloc(f->data, new_cap);
+    }
+    if (grown == NULL) {
+      return WRDE_NOSPACE;
+    }
+    f->data = grown;
+    f->cap = new_cap;
+  }
+
+  f->data[f->len++] = c;
+  f->started = true;
+  return 0;
+}
+
+
+/**
+ * Append a quoted byte, escaping it if it would be special to glob().
+ * @param f Field.
+ * @param c Byte to append.
+ * @return 0 on success, WRDE_NOSPACE on allocation failure.
+ */
+static int field_put_quoted(ExpandField* f, char c) {
+  if (c == '*' || c == '?' || c == '[' || c == '\\') {
+    if (field_putc(f, '\\') != 0) {
+      return WRDE_NOSPACE;
+    }
+  }
+  return field_putc(f, c);
+}
+
+
+/**
+ * Append an unquoted byte; glob metacharacters stay active.
+ * @param f Field.
+ * @param c Byte to append.
+ * @return 0 on success, WRDE_NOSPACE on allocation failure.
+ */
+static int field_put_unquoted(ExpandField* f, char c) {
+  if (c == '*' || c == '?' || c == '[') {
+    f->has_glob = true;
+    return field_putc(f, c);
+  }
+  return field_put_quoted(f, c);
+}
+
+
+/**
+ * Finish the current field, globbing it if needed, and start a new one.
+ * @param f Field.
+ * @param words Word list receiving the field (or its matches).
+ * @return 0 on success, WRDE_NOSPACE on allocation failure.
+ */
+static int field_emit(ExpandField* f, JShellWords* words) {
+  int result = 0;
+
+  if (f->has_glob) {
+    if (field_putc(f, '\0') != 0) {
+      return WRDE_NOSPACE;
+    }
+    f->len--;
+
+    glob_t matches;
+    int glob_result = glob(f->data, 0, NULL, &matches);
+    if (glob_result == 0) {
+      for (size_t i = 0; i < matches.gl_pathc && result == 0; i++) {
+        result = words_push(words, matches.gl_pathv[i],
+                            strlen(matches.gl_pathv[i]), false);
+      }
+      globfree(&matches);
+    } else if (glob_result == GLOB_NOSPACE) {
+      result = WRDE_NOSPACE;
+    } else {
+      /* No match: the word is kept as written, minus quotes */
+      result = words_push(words, f->data, f->len, true);
+    }
+  } else {
+    result = words_push(words, f->data, f->len, true);
+  }
+
+  f->len = 0;
+  f->started = false;
+  f->has_glob = false;
+  return result;
+}
+
+
+/**
+ * Append the value of a parameter expansion.
+ *
+ * Unquoted values are split on IFS and their glob characters stay active;
+ * quoted values are appended as they are.
+ *
+ * @param f Field.
+ * @param words Word list receiving completed fields.
+ * @param value Expanded value (NULL for an unset variable).
+ * @param quoted Whether the expansion appeared inside double quotes.
+ * @return 0 on success, WRDE_NOSPACE on allocation failure.
+ */
+static int field_put_value(ExpandField* f, JShellWords* words,
+                           const char* value, bool quoted) {
+  if (quoted) {
+    f->started = true;
+  }
+  if (value == NULL) {
+    return 0;
+  }
+
+  const char* ifs = jshell_var_get("IFS");
+  if (ifs == NULL) {
+    ifs = " \t\n";
+  }
+
+  for (const char* p = value; *p; p++) {
+    int result;
+    if (quoted) {
+      result = field_put_quoted(f, *p);
+    } else if (strchr(ifs, *p) != NULL) {
+      bool is_space = (*p == ' ' || *p == '\t' || *p == '\n');
+      /* Runs of IFS whitespace collapse; other IFS characters always
+       * delimit a field, even an empty one */
+      result = (f->started || !is_space) ? field_emit(f, words) : 0;
+    } else {
+      result = field_put_unquoted(f, *p);
+    }
+    if (result != 0) {
+      return result;
+    }
+  }
+
+  return 0;
+}
+
+
+/**
+ * Check whether a byte may start a variable name.
+ * @param c Byte to check.
+ * @return true for [A-Za-z_].
+ */
+static bool is_name_start(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+
+/**
+ * Check whether a byte may continue a variable name.
+ * @param c Byte to check.
+ * @return true for [A-Za-z0-9_].
+ */
+static bool is_name_char(char c) {
+  return is_name_start(c) || (c >= '0' && c <= '9');
+}
+
+
+/**
+ * Expand the parameter starting at the '$' at s[*pos].
+ * @param s Word text.
+ * @param pos Position of the '$'; advanced past the expansion.
+ * @param f Field.
+ * @param words Word list receiving completed fields.
+ * @param quoted Whether the expansion appeared inside double quotes.
+ * @return 0, WRDE_NOSPACE, or EXPAND_UNSUPPORTED.
+ */
+static int expand_parameter(const char* s, size_t* pos, ExpandField* f,
+                            JShellWords* words, bool quoted) {
+  const char* p = s + *pos + 1;
+  const char* name = p;
+  size_t name_len = 0;
+  size_t consumed;
+
+  if (*p == '{') {
+    name = p + 1;
+    while (is_name_char(name[name_len])) {
+      name_len++;
+    }
+    if (name_len == 0 || !is_name_start(name[0]) || name[name_len] != '}') {
+      return EXPAND_UNSUPPORTED;
+    }
+    consumed = name_len + 3;
+  } else if (is_name_start(*p)) {
+    while (is_name_char(name[name_len])) {
+      name_len++;
+    }
+    consumed = name_len + 1;
+  } else if (*p == '?') {
+    char status[16];
+    snprintf(status, sizeof(status), "%d", jshell_get_last_exit_status());
+    *pos += 2;
+    return field_put_value(f, words, status, quoted);
+  } else if (*p != '\0' && strchr("0123456789#@*!$-({", *p) != NULL) {
+    return EXPAND_UNSUPPORTED;
+  } else {
+    /* A '$' that starts no expansion is literal */
+    *pos += 1;
+    return field_putc(f, '$');
+  }
+
+  char name_buf[256];
+  if (name_len >= sizeof(name_buf)) {
+    return EXPAND_UNSUPPORTED;
+  }
+  memcpy(name_buf, name, name_len);
+  name_buf[name_len] = '\0';
+
+  *pos += consumed;
+  return field_put_value(f, words, jshell_var_get(name_buf), quoted);
+}
+
+
+/**
+ * Expand a word without wordexp().
+ * @param s Word text.
+ * @param f Empty field used as scratch space.
+ * @param words Word list receiving the fields.
+ * @return 0, WRDE_NOSPACE, or EXPAND_UNSUPPORTED.
+ */
+static int expand_native(const char* s, ExpandField* f, JShellWords* words) {
+  size_t i = 0;
+  bool in_dquote = false;
+  int result = 0;
+
+  if (s[0] == '~') {
+    const char* home = jshell_var_get("HOME");
+    if ((s[1] != '\0' && s[1] != '/') || home == NULL) {
+      return EXPAND_UNSUPPORTED;
+    }
+    result = field_put_value(f, words, home, true);
+    i = 1;
+  }
+
+  while (s[i] != '\0' && result == 0) {
+    char c = s[i];
+
+    if (in_dquote) {
+      if (c == '"') {
+        in_dquote = false;
+        i++;
+      } else if (c == '`' || (c == '\\' && s[i + 1] == '\n')) {
+        return EXPAND_UNSUPPORTED;
+      } else if (c == '\\' && s[i + 1] != '\0'
+                 && strchr("$`\"\\", s[i + 1]) != NULL) {
+        result = field_put_quoted(f, s[i + 1]);
+        i += 2;
+      } else if (c == '$') {
+        result = expand_parameter(s, &i, f, words, true);
+      } else {
+        result = field_put_quoted(f, c);
+        i++;
+      }
+      continue;
+    }
+
+    switch (c) {
+    case '\'': {
+      const char* end = strchr(s + i + 1, '\'');
+      if (end == NULL) {
+        return EXPAND_UNSUPPORTED;
+      }
+      f->started = true;
+      for (const char* p = s + i + 1; p < end && result == 0; p++) {
+        result = field_put_quoted(f, *p);
+      }
+      i = (size_t)(end - s) + 1;
+      break;
+    }
+    case '"':
+      in_dquote = true;
+      f->started = true;
+      i++;
+      break;
+    case '\\':
+      if (s[i + 1] == '\0' || s[i + 1] == '\n') {
+        return EXPAND_UNSUPPORTED;
+      }
+      result = field_put_quoted(f, s[i + 1]);
+      i += 2;
+      break;
+    case '$':
+      result = expand_parameter(s, &i, f, words, false);
+      break;
+    case '`': case '|': case '&': case ';': case '<': case '>':
+    case '(': case ')': case '\n':
+      return EXPAND_UNSUPPORTED;
+    default:
+      result = field_put_unquoted(f, c);
+      i++;
+      break;
+    }
+  }
+
+  if (result != 0) {
+    return result;
+  }
+  if (in_dquote) {
+    return EXPAND_UNSUPPORTED;
+  }
+  return f->started ? field_emit(f, words) : 0;
+}
+
+
+/**
+ * Expand a word with wordexp() and copy the results into the arena.
+ * @param word Word text.
+ * @param words Word list receiving the fields.
+ * @return 0 on success, wordexp error code on failure.
+ */
+static int expand_fallback(const char* word, JShellWords* words) {
+  wordexp_t expansion = {0};
+  /* wordexp() reads variables from environ, which has no shell-locals */
+  jshell_vars_expose_locals(true);
+  int result = wordexp(word, &expansion, WRDE_NOCMD);
+  jshell_vars_expose_locals(false);
+  if (result != 0) {
+    if (result == WRDE_NOSPACE) {
+      wordfree(&expansion);
+    }
+    return result;
+  }
+
+  for (size_t i = 0; i < expansion.we_wordc && result == 0; i++) {
+    result = words_push(words, expansion.we_wordv[i],
+                        strlen(expansion.we_wordv[i]), false);
+  }
+
+  wordfree(&expansion);
+  return result;
+}
+
+
+/**
+ * @brief Expands a word with shell semantics, appending to a word list.
+ *
+ * Plain words are copied as they are. Words with quotes, parameters, ~ or
+ * glob characters go through the native expander, and anything it does
+ * not support is handed to wordexp() with command substitution disabled.
+ *
+ * @param word The word string to expand.
+ * @param words Word list receiving the fields.
+ * @return 0 on success, WRDE_* error code on failure.
+ */
+int jshell_expand_word(const char* word, JShellWords* words) {
+  size_t len = strlen(word);
+  if (word[strcspn(word, EXPAND_SPECIAL_CHARS)] == '\0') {
+    return words_push(words, word, len, false);
+  }
+
+  ExpandField field = {
+    .cap = EXPAND_FIELD_INLINE_SIZE,
+  };
+  field.data = field.inline_data;
+
+  size_t start_count = words->wordc;
+  int result = expand_native(word, &field, words);
+
+  if (field.data != field.inline_data) {
+    free(field.data);
+  }
+
+  if (result == EXPAND_UNSUPPORTED) {
+    DPRINT("Falling back to wordexp for: %s", word);
+    words->wordc = start_count;
+    if (words->wordv != NULL) {
+      words->wordv[start_count] = NULL;
+    }
+    return expand_fallback(word, words);
+  }
+
+  return result;
+}
+
+
+/**
+ * @brief Appends a word to an expanded word list as it is.
+ * @param words Word list.
+ * @param text Word to copy.
+ * @return 0 on success, WRDE_NOSPACE on allocation failure.
+ */
+int jshell_words_append(JShellWords* words, const char* text) {
+  return words_push(words, text, strlen(text), false);
+}
+
+
+/**
+ * @brief Frees an expanded word list and its arena.
+ * @param words Word list to free; left empty and reusable.
+ */
+void jshell_words_free(JShellWords* words) {
+  JShellArenaChunk* chunk = words->arena.head;
+  while (chunk != NULL) {
+    JShellArenaChunk* next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+
+  free(words->wordv);
+  memset(words, 0, sizeof(*words));
+}
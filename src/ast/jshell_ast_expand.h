@@ -0,0 +1,45 @@
+#ifndef JSHELL_AST_EXPAND_H
+#define JSHELL_AST_EXPAND_H
+
+#include <stddef.h>
+
+
+// Size of a regular arena chunk (larger requests get their own chunk)
+#define EXPAND_ARENA_CHUNK_SIZE 1024
+// Field bytes kept on the stack before the scratch buffer moves to the heap
+#define EXPAND_FIELD_INLINE_SIZE 256
+
+
+typedef struct JShellArenaChunk JShellArenaChunk;
+
+
+// Bump allocator owning the text of one command's words
+typedef struct {
+  JShellArenaChunk* head;
+} JShellArena;
+
+
+// Expanded words of one command (replaces wordexp_t)
+typedef struct {
+  size_t wordc;
+  char** wordv;       // NULL-terminated; strings live in arena
+  size_t wordv_cap;
+  JShellArena arena;
+} JShellWords;
+
+
+// Expand word and append the resulting fields to words
+// Handles quoting, $NAME, ${NAME}, $?, ~ and globbing natively and falls
+// back to wordexp() for anything else (no command substitution)
+// Returns 0 on success or a WRDE_* error code
+int jshell_expand_word(const char* word, JShellWords* words);
+
+// Append a copy of text to words as one more word, without expansion
+// Returns 0 on success or WRDE_NOSPACE
+int jshell_words_append(JShellWords* words, const char* text);
+
+// Free all words and their arena; words is left empty and reusable
+void jshell_words_free(JShellWords* words);
+
+
+#endif
@@ -7,7 +7,7 @@
  * process management for both foreground and background jobs.
  */
 
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,17 +15,31 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <sys/mman.h>
 #include <fcntl.h>
-#include <wordexp.h>
 #include <signal.h>
 #include <ctype.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 
 #include "jshell/jshell_cmd_registry.h"
 #include "jshell/jshell_path.h"
 #include "jshell/jshell_thread_exec.h"
+#include "jshell/jshell_socketpair.h"
+#include "jshell/jshell_spawn.h"
+#include "jshell/jshell_spool.h"
 #include "jshell/jshell_signals.h"
+#include "jshell/jshell_stats.h"
 #include "jshell/jshell_pkg_loader.h"
+#include "jshell/jshell_register_externals.h"
+#include "jshell/jshell_result_cache.h"
+#include "jshell/jshell_trace.h"
+#include "jshell/jshell_usage.h"
+#include "jshell/jshell_vars.h"
+#include "utils/jbox_json.h"
 #include "utils/jbox_utils.h"
 #include "jshell/jshell.h"
 #include "jshell/jshell_job_control.h"
@@ -35,115 +49,89 @@
 
 
 /**
- * @brief Performs word expansion using wordexp with shell semantics.
+ * @brief Tells whether a stage may read and write ring pipes.
  *
- * Expands words including variables, globs, and other shell expansions.
- * Appends results to existing word vector if it already contains words.
+ * Builtins only use their JShellIO streams, which can sit on a ring;
+ * linked apps also read and write the raw descriptors (splice, sendfile)
+ * and need real ones.
  *
- * @param word The word string to expand.
- * @param word_vector_ptr Pointer to wordexp_t structure for results.
- * @return 0 on success, wordexp error code on failure.
+ * @param spec Command of the stage.
+ * @param in_process Whether the stage runs on a thread.
+ * @return true if the stage can be given ring pipe ends.
  */
-int jshell_expand_word(char* word, wordexp_t* word_vector_ptr) {
-  int flags = WRDE_NOCMD;
-  
-  if(word_vector_ptr->we_wordc > 0){
-    DPRINT("word_vector_ptr->we_wordc = %zu => flags |= WRDE_APPEND", 
-           word_vector_ptr->we_wordc);
-    flags |= WRDE_APPEND;
-  }
-  return wordexp(word, word_vector_ptr, flags);
+static bool jshell_stage_takes_ring(const jshell_cmd_spec_t* spec,
+                                    bool in_process) {
+  return in_process && spec->type == CMD_BUILTIN
+         && !jshell_is_linked_command(spec);
 }
 
 
 /**
- * @brief Sets up input redirection by duplicating file descriptor to stdin.
+ * @brief Tells whether a stage may send binary records to the next one.
  *
- * @param input_fd File descriptor to redirect to stdin, or -1 for no redirect.
- * @return 0 on success, -1 on error.
- */
-static int jshell_setup_input_redir(int input_fd) {
-  if (input_fd == -1) {
-    return 0;
-  }
-  
-  if (dup2(input_fd, STDIN_FILENO) == -1) {
-    perror("dup2 input");
-    return -1;
-  }
-  
-  close(input_fd);
-  return 0;
-}
-
-
-/**
- * @brief Sets up output redirection by duplicating file descriptor to stdout.
+ * Both ends must run in the shell, so the records never leave the
+ * process, and the reader must take records; the writer decides itself
+ * whether it has structured output to send that way. The last stage
+ * always writes text, so records are rendered as JSON at the terminal,
+ * a file or a capture.
  *
- * @param output_fd File descriptor to redirect to stdout, or -1 for no redirect.
- * @return 0 on success, -1 on error.
+ * @param stages The stages, with their specs resolved.
+ * @param in_process Per-stage flags, true for stages run on a thread.
+ * @param index Writing stage.
+ * @param cmd_count Number of stages.
+ * @return true if the link after stage index carries records.
  */
-static int jshell_setup_output_redir(int output_fd) {
-  if (output_fd == -1) {
-    return 0;
-  }
-  
-  if (dup2(output_fd, STDOUT_FILENO) == -1) {
-    perror("dup2 output");
-    return -1;
-  }
-  
-  close(output_fd);
-  return 0;
+static bool jshell_link_carries_records(const JShellCmdParams* stages,
+                                        const bool* in_process,
+                                        size_t index, size_t cmd_count) {
+  return index + 1 < cmd_count && in_process[index]
+         && in_process[index + 1] && stages[index + 1].spec->reads_records;
 }
 
 
 /**
- * @brief Creates an array of pipes for command pipeline execution.
+ * @brief Creates the pipes connecting the stages of a pipeline.
  *
- * Allocates and initializes pipe file descriptors for connecting commands
- * in a pipeline.
+ * Two adjacent builtin stages are connected with an in-process ring, so
+ * their data never goes through the kernel. Other in-process (threaded)
+ * neighbours, i.e. linked apps, get a socketpair; any link that involves
+ * a forked stage uses a regular pipe.
  *
  * @param pipe_count Number of pipes to create (cmd_count - 1).
- * @return Array of pipe file descriptor pairs, or NULL on error.
+ * @param stages The stages, with their specs resolved.
+ * @param in_process Per-stage flags, true for stages run on a thread.
+ * @return Array of pipe_count pipes, or NULL on error.
  */
-static int** jshell_create_pipes(size_t pipe_count) {
+static JShellPipe* jshell_create_pipes(size_t pipe_count,
+                                       const JShellCmdParams* stages,
+                                       const bool* in_process) {
   if (pipe_count == 0) {
     return NULL;
   }
-  
-  int** pipes = malloc(sizeof(int*) * pipe_count);
+
+  JShellPipe* pipes = malloc(sizeof(JShellPipe) * pipe_count);
   if (pipes == NULL) {
     perror("malloc pipes");
     return NULL;
   }
-  
+
   for (size_t i = 0; i < pipe_count; i++) {
-    pipes[i] = malloc(sizeof(int) * 2);
-    if (pipes[i] == NULL) {
-      perror("malloc pipe");
-      for (size_t j = 0; j < i; j++) {
-        close(pipes[j][0]);
-        close(pipes[j][1]);
-        free(pipes[j]);
-      }
-      free(pipes);
-      return NULL;
+    int rc;
+    if (jshell_stage_takes_ring(stages[i].spec, in_process[i])
+        && jshell_stage_takes_ring(stages[i + 1].spec, in_process[i + 1])) {
+      rc = jshell_create_ring_pipe(&pipes[i]);
+    } else {
+      rc = jshell_create_pipe(&pipes[i], in_process[i] && in_process[i + 1]);
     }
-    
-    if (pipe(pipes[i]) == -1) {
-      perror("pipe");
-      free(pipes[i]);
+    if (rc == -1) {
       for (size_t j = 0; j < i; j++) {
-        close(pipes[j][0]);
-        close(pipes[j][1]);
-        free(pipes[j]);
+        jshell_close_pipe(&pipes[j]);
       }
       free(pipes);
       return NULL;
     }
   }
-  
+
   return pipes;
 }
 
@@ -151,108 +139,103 @@ static int** jshell_create_pipes(size_t pipe_count) {
 /**
  * @brief Closes and frees an array of pipes.
  *
- * @param pipes Array of pipe file descriptor pairs.
+ * Ends already handed off to a builtin thread are marked -1 (NULL for
+ * ring ends) and skipped.
+ *
+ * @param pipes Array of pipes.
  * @param pipe_count Number of pipes in the array.
  */
-static void jshell_close_pipes(int** pipes, size_t pipe_count) {
+static void jshell_close_pipes(JShellPipe* pipes, size_t pipe_count) {
   if (pipes == NULL) {
     return;
   }
-  
+
   for (size_t i = 0; i < pipe_count; i++) {
-    if (pipes[i] != NULL) {
-      close(pipes[i][0]);
-      close(pipes[i][1]);
-      free(pipes[i]);
-    }
+    jshell_close_pipe(&pipes[i]);
   }
   free(pipes);
 }
 
 
 /**
- * @brief Finds a builtin command by name in the command registry.
+ * @brief Resolves the executable path for a command in the parent process.
+ *
+ * Package commands use their registered binary and apps linked into jbox
+ * run this same binary, which dispatches on argv[0]; everything else goes
+ * through the cached PATH lookup. Resolving before the launch keeps the
+ * result in the parent's cache and spares each child a fresh PATH search.
  *
- * @param name The command name to look up.
- * @return Pointer to command spec if found, NULL otherwise.
+ * @param cmd_params The command, with its spec resolved during expansion.
+ * @return Allocated path, or NULL if the command could not be resolved.
  */
-static const jshell_cmd_spec_t* jshell_find_builtin(const char* name) {
-  if (name == NULL) {
-    return NULL;
+static char* jshell_resolve_exec_path(const JShellCmdParams* cmd_params) {
+  const jshell_cmd_spec_t* cmd_spec = cmd_params->spec;
+  if (cmd_spec != NULL && cmd_spec->type == CMD_PACKAGE
+      && cmd_spec->bin_path != NULL) {
+    return strdup(cmd_spec->bin_path);
+  }
+  if (jshell_is_linked_command(cmd_spec) && jshell_self_exe_path() != NULL) {
+    return strdup(jshell_self_exe_path());
   }
-  return jshell_find_command(name);
+  return jshell_resolve_command(cmd_params->argv[0]);
+}
+
+
+/**
+ * @brief Decides whether an app linked into jbox runs inside the shell.
+ *
+ * Only foreground commands whose output does not go to a terminal do;
+ * interactive ones run as a child of their own so that Ctrl+C, terminal
+ * modes and job control behave as for any other program.
+ *
+ * @param job_type Foreground or background job type.
+ * @param output_fd Where the command writes, or -1 for the shell's stdout.
+ * @return true if the app may be called through its run function.
+ */
+static bool jshell_linked_runs_in_process(ExecJobType job_type,
+                                          int output_fd) {
+  return job_type == FG_JOB
+         && !isatty(output_fd != -1 ? output_fd : STDOUT_FILENO);
 }
 
 
 /**
  * @brief Executes a builtin command directly on the main thread.
  *
- * Handles I/O redirection, executes the builtin, and restores original
- * file descriptors. Used for builtins that must run on the main thread.
+ * Handles I/O redirection through jshell_run_builtin, which gives builtins
+ * private streams and leaves the shell's own descriptors alone. Used for
+ * builtins that must run on the main thread.
  *
  * @param spec The command specification.
  * @param cmd_params Command parameters (argc/argv).
  * @param input_fd Input redirection fd, or -1 for none.
  * @param output_fd Output redirection fd, or -1 for none.
+ * @param usage Set to the usage of the run when timed, or NULL.
  * @return Exit status from the builtin command.
  */
 static int jshell_exec_builtin_direct(const jshell_cmd_spec_t* spec,
                                        JShellCmdParams* cmd_params,
                                        int input_fd,
-                                       int output_fd) {
+                                       int output_fd,
+                                       JShellUsage* usage) {
   DPRINT("Executing builtin directly: %s", spec->name);
 
-  int saved_stdin = -1;
-  int saved_stdout = -1;
-  int result = 0;
-
-  if (input_fd != -1) {
-    saved_stdin = dup(STDIN_FILENO);
-    if (saved_stdin == -1) {
-      perror("dup stdin");
-      return -1;
-    }
-    if (jshell_setup_input_redir(input_fd) == -1) {
-      close(saved_stdin);
-      return -1;
-    }
-  }
-
-  if (output_fd != -1) {
-    saved_stdout = dup(STDOUT_FILENO);
-    if (saved_stdout == -1) {
-      perror("dup stdout");
-      if (saved_stdin != -1) {
-        dup2(saved_stdin, STDIN_FILENO);
-        close(saved_stdin);
-      }
-      return -1;
-    }
-    if (jshell_setup_output_redir(output_fd) == -1) {
-      close(saved_stdout);
-      if (saved_stdin != -1) {
-        dup2(saved_stdin, STDIN_FILENO);
-        close(saved_stdin);
-      }
-      return -1;
-    }
+  JShellUsage before = {0};
+  uint64_t start = 0;
+  if (usage != NULL) {
+    jshell_usage_of_thread(&before);
+    start = jshell_usage_now();
   }
 
-  result = spec->run(cmd_params->argc, cmd_params->argv);
+  int result = jshell_run_builtin(spec, cmd_params->argc, cmd_params->argv,
+                                  input_fd, output_fd);
 
-  /* Flush stdout to ensure output appears before next command */
-  fflush(stdout);
-
-  if (saved_stdout != -1) {
-    dup2(saved_stdout, STDOUT_FILENO);
-    close(saved_stdout);
-  }
-
-  if (saved_stdin != -1) {
-    dup2(saved_stdin, STDIN_FILENO);
-    close(saved_stdin);
+  if (usage != NULL) {
+    jshell_usage_of_thread(usage);
+    usage->user_us -= before.user_us;
+    usage->sys_us -= before.sys_us;
+    usage->wall_us = jshell_usage_now() - start;
   }
-
   return result;
 }
 
@@ -267,17 +250,47 @@ static int jshell_exec_builtin_direct(const jshell_cmd_spec_t* spec,
  * @param cmd_params Command parameters (argc/argv).
  * @param input_fd Input redirection fd, or -1 for none.
  * @param output_fd Output redirection fd, or -1 for none.
+ * @param output_stream Stream written instead of output_fd, or NULL; only
+ *                      for builtins that run on a thread.
+ * @param usage Set to the usage of the run when timed, or NULL.
  * @return Exit status from the builtin command.
  */
 static int jshell_exec_builtin(const jshell_cmd_spec_t* spec,
                                 JShellCmdParams* cmd_params,
                                 int input_fd,
-                                int output_fd) {
+                                int output_fd,
+                                FILE* output_stream,
+                                JShellUsage* usage) {
   DPRINT("Executing builtin: %s", spec->name);
 
+  if (output_stream != NULL) {
+    JShellStageIO io = {
+      .input_fd = input_fd,
+      .output_fd = -1,
+      .output_stream = output_stream,
+    };
+    JShellBuiltinThread* bt = jshell_spawn_builtin_stage(
+      spec, cmd_params->argc, cmd_params->argv, &io);
+    if (bt == NULL) {
+      fprintf(stderr, "jshell: %s: could not start builtin thread\n",
+              spec->name);
+      if (input_fd != -1) {
+        close(input_fd);
+      }
+      return 1;
+    }
+    int result = jshell_wait_builtin_thread(bt);
+    if (usage != NULL) {
+      *usage = bt->usage;
+    }
+    jshell_free_builtin_thread(bt);
+    return result;
+  }
+
   if (jshell_builtin_requires_main_thread(spec->name)) {
     DPRINT("Builtin %s requires main thread execution", spec->name);
-    return jshell_exec_builtin_direct(spec, cmd_params, input_fd, output_fd);
+    return jshell_exec_builtin_direct(spec, cmd_params, input_fd, output_fd,
+                                      usage);
   }
 
   JShellBuiltinThread* bt = jshell_spawn_builtin_thread(
@@ -286,10 +299,14 @@ static int jshell_exec_builtin(const jshell_cmd_spec_t* spec,
 
   if (bt == NULL) {
     DPRINT("Failed to spawn thread, falling back to direct execution");
-    return jshell_exec_builtin_direct(spec, cmd_params, input_fd, output_fd);
+    return jshell_exec_builtin_direct(spec, cmd_params, input_fd, output_fd,
+                                      usage);
   }
 
   int result = jshell_wait_builtin_thread(bt);
+  if (usage != NULL) {
+    *usage = bt->usage;
+  }
   jshell_free_builtin_thread(bt);
 
   return result;
@@ -297,115 +314,54 @@ static int jshell_exec_builtin(const jshell_cmd_spec_t* spec,
 
 
 /**
- * @brief Forks a child process and executes an external command.
+ * @brief Counts a command about to be started as a child process.
+ *
+ * @param cmd_params The command, with its spec resolved during expansion.
+ */
+static void jshell_count_spawned(const JShellCmdParams* cmd_params) {
+  bool package = cmd_params->spec != NULL
+                 && cmd_params->spec->type == CMD_PACKAGE;
+  jshell_stats_add(package ? JSHELL_STAT_CMD_PACKAGE
+                           : JSHELL_STAT_CMD_EXTERNAL, 1);
+}
+
+
+/**
+ * @brief Launches one external stage of a pipeline.
  *
- * Sets up pipe connections for pipelines, handles I/O redirection,
- * and executes the command via execv/execvp.
+ * Connects the stage to its neighbouring pipes (or to the job's
+ * redirections at either end). Every pipe end and redirection is
+ * close-on-exec, so the child keeps only the two it gets as stdin and
+ * stdout and downstream stages still see EOF when their writer exits,
+ * without a close list that grows with the pipeline.
  *
  * @param cmd_params Command parameters (argc/argv).
- * @param pipes Array of pipe file descriptor pairs.
+ * @param exec_path Executable path resolved by the parent, or NULL.
+ * @param pipes Array of pipes connecting the pipeline stages.
  * @param cmd_index Index of this command in the pipeline.
  * @param total_cmds Total number of commands in the pipeline.
  * @param input_fd Input redirection fd for first command, or -1.
  * @param output_fd Output redirection fd for last command, or -1.
+ * @param failure_status Set to the stage's status if it cannot be run.
  * @return PID of child process, or -1 on error.
  */
-static int jshell_fork_and_exec(JShellCmdParams* cmd_params,
-                                 int** pipes,
-                                 size_t cmd_index,
-                                 size_t total_cmds,
-                                 int input_fd,
-                                 int output_fd) {
-  DPRINT("Forking for command %zu: %s", cmd_index, cmd_params->argv[0]);
-  
-  pid_t pid = fork();
-  
-  if (pid == -1) {
-    perror("fork");
-    return -1;
-  }
-  
-  if (pid == 0) {
-    /* Reset signal handlers to default for child process */
-    jshell_reset_signals_for_child();
-
-    if (cmd_index == 0 && input_fd != -1) {
-      if (jshell_setup_input_redir(input_fd) == -1) {
-        exit(EXIT_FAILURE);
-      }
-    }
-
-    if (cmd_index > 0) {
-      if (dup2(pipes[cmd_index - 1][0], STDIN_FILENO) == -1) {
-        perror("dup2 pipe read");
-        exit(EXIT_FAILURE);
-      }
-    }
-
-    if (cmd_index < total_cmds - 1) {
-      if (dup2(pipes[cmd_index][1], STDOUT_FILENO) == -1) {
-        perror("dup2 pipe write");
-        exit(EXIT_FAILURE);
-      }
-    }
-
-    if (cmd_index == total_cmds - 1 && output_fd != -1) {
-      if (jshell_setup_output_redir(output_fd) == -1) {
-        exit(EXIT_FAILURE);
-      }
-    }
-
-    for (size_t i = 0; i < total_cmds - 1; i++) {
-      close(pipes[i][0]);
-      close(pipes[i][1]);
-    }
-
-    // Check if this is a package command
-    const jshell_cmd_spec_t* cmd_spec = jshell_find_command(cmd_params->argv[0]);
-    if (cmd_spec != NULL && cmd_spec->type == CMD_PACKAGE
-        && cmd_spec->bin_path != NULL) {
-      execv(cmd_spec->bin_path, cmd_params->argv);
-      if (errno == EACCES) {
-        fprintf(stderr, "jshell: %s: Permission denied\n",
-                cmd_params->argv[0]);
-        exit(126);
-      }
-      fprintf(stderr, "jshell: %s: %s\n", cmd_params->argv[0],
-              strerror(errno));
-      exit(127);
-    }
+static pid_t jshell_spawn_stage(JShellCmdParams* cmd_params,
+                                const char* exec_path,
+                                JShellPipe* pipes,
+                                size_t cmd_index,
+                                size_t total_cmds,
+                                int input_fd,
+                                int output_fd,
+                                int* failure_status) {
+  DPRINT("Spawning command %zu: %s", cmd_index, cmd_params->argv[0]);
 
-    char* resolved_path = jshell_resolve_command(cmd_params->argv[0]);
-    if (resolved_path != NULL) {
-      execv(resolved_path, cmd_params->argv);
-      if (errno == EACCES) {
-        fprintf(stderr, "jshell: %s: Permission denied\n",
-                cmd_params->argv[0]);
-        free(resolved_path);
-        exit(126);
-      }
-      fprintf(stderr, "jshell: %s: %s\n", cmd_params->argv[0],
-              strerror(errno));
-      free(resolved_path);
-      exit(127);
-    } else {
-      execvp(cmd_params->argv[0], cmd_params->argv);
-      if (errno == EACCES) {
-        fprintf(stderr, "jshell: %s: Permission denied\n",
-                cmd_params->argv[0]);
-        exit(126);
-      } else if (errno == ENOENT) {
-        fprintf(stderr, "jshell: %s: command not found\n",
-                cmd_params->argv[0]);
-      } else {
-        fprintf(stderr, "jshell: %s: %s\n", cmd_params->argv[0],
-                strerror(errno));
-      }
-    }
-    exit(127);
-  }
+  int stdin_fd = (cmd_index == 0) ? input_fd : pipes[cmd_index - 1].read_fd;
+  int stdout_fd = (cmd_index == total_cmds - 1) ? output_fd
+                                                : pipes[cmd_index].write_fd;
 
-  return pid;
+  jshell_count_spawned(cmd_params);
+  return jshell_spawn_command(exec_path, cmd_params->argv,
+                              stdin_fd, stdout_fd, NULL, 0, failure_status);
 }
 
 
@@ -418,10 +374,13 @@ static int jshell_fork_and_exec(JShellCmdParams* cmd_params,
  * @param pids Array of process IDs to wait for.
  * @param pid_count Number of processes in the array.
  * @param job_type Foreground or background job type.
+ * @param usage Filled in for each process when timed, or NULL.
+ * @param started When the processes were started, for usage->wall_us.
  * @return Exit status of last process, or 0 for background jobs.
  */
 static int jshell_wait_for_jobs(pid_t* pids, size_t pid_count,
-                                 ExecJobType job_type) {
+                                 ExecJobType job_type, JShellUsage* usage,
+                                 uint64_t started) {
   if (job_type == BG_JOB) {
     DPRINT("Background job, not waiting");
     return 0;
@@ -432,10 +391,17 @@ static int jshell_wait_for_jobs(pid_t* pids, size_t pid_count,
   
   for (size_t i = 0; i < pid_count; i++) {
     int status;
-    if (waitpid(pids[i], &status, 0) == -1) {
-      perror("waitpid");
+    struct rusage ru;
+    uint64_t trace_start = jshell_trace_begin();
+    if (wait4(pids[i], &status, 0, &ru) == -1) {
+      perror("wait4");
       return -1;
     }
+    jshell_trace_end("wait", NULL, trace_start);
+    if (usage != NULL) {
+      jshell_usage_from_rusage(&usage[i], &ru);
+      usage[i].wall_us = jshell_usage_now() - started;
+    }
     
     if (WIFEXITED(status)) {
       last_status = WEXITSTATUS(status);
@@ -502,69 +468,53 @@ static char* jshell_build_cmd_string(JShellCmdVector* cmd_vector) {
 
 
 /**
- * @brief Executes a package command by forking and exec'ing the binary.
+ * @brief Launches a single external command and waits for it.
  *
- * Package commands are external binaries installed via the package manager.
- * This function handles their execution with proper I/O redirection.
+ * Installs the job's redirections as the child's stdin/stdout, registers
+ * background jobs, and waits for foreground ones.
  *
- * @param spec The command specification with bin_path.
+ * @param exec_path Executable path resolved by the parent, or NULL.
  * @param cmd_params Command parameters (argc/argv).
  * @param job The execution job containing redirection info.
  * @return Exit status of the command.
  */
-static int jshell_exec_package_cmd(const jshell_cmd_spec_t* spec,
-                                   JShellCmdParams* cmd_params,
-                                   JShellExecJob* job) {
-  DPRINT("Executing package command: %s -> %s", spec->name, spec->bin_path);
-
-  pid_t pid = fork();
-  if (pid == -1) {
-    perror("fork");
-    return -1;
-  }
-
-  if (pid == 0) {
-    jshell_reset_signals_for_child();
-
-    if (jshell_setup_input_redir(job->input_fd) == -1) {
-      exit(EXIT_FAILURE);
-    }
-
-    if (jshell_setup_output_redir(job->output_fd) == -1) {
-      exit(EXIT_FAILURE);
-    }
-
-    execv(spec->bin_path, cmd_params->argv);
-    if (errno == EACCES) {
-      fprintf(stderr, "jshell: %s: Permission denied\n", cmd_params->argv[0]);
-      exit(126);
-    }
-    fprintf(stderr, "jshell: %s: %s\n", cmd_params->argv[0], strerror(errno));
-    exit(127);
-  }
+static int jshell_spawn_and_wait(const char* exec_path,
+                                 JShellCmdParams* cmd_params,
+                                 JShellExecJob* job) {
+  int failure_status;
+  jshell_count_spawned(cmd_params);
+  pid_t pid = jshell_spawn_command(exec_path, cmd_params->argv,
+                                   job->input_fd, job->output_fd,
+                                   NULL, 0, &failure_status);
+  jshell_sched_apply(&job->sched, pid);
 
   if (job->input_fd != -1) {
     close(job->input_fd);
+    job->input_fd = -1;
   }
   if (job->output_fd != -1) {
     close(job->output_fd);
+    job->output_fd = -1;
+  }
+
+  if (pid == -1) {
+    return failure_status;
   }
 
   if (job->exec_job_type == BG_JOB) {
     char* cmd_string = jshell_build_cmd_string(job->jshell_cmd_vector_ptr);
-    jshell_add_background_job(&pid, 1, cmd_string);
+    int job_id = jshell_add_background_job(&pid, 1, cmd_string, &job->sched);
+    if (job->spool != NULL) {
+      jshell_job_set_spool(job_id, job->spool);
+      job->spool = NULL;
+    }
     if (cmd_string != NULL) {
       free(cmd_string);
     }
-    return 0;
   }
 
-  int status;
-  waitpid(pid, &status, 0);
-  if (WIFEXITED(status)) {
-    return WEXITSTATUS(status);
-  }
-  return -1;
+  return jshell_wait_for_jobs(&pid, 1, job->exec_job_type,
+                              job->stage_usage, job->time_start);
 }
 
 
@@ -572,7 +522,13 @@ static int jshell_exec_package_cmd(const jshell_cmd_spec_t* spec,
  * @brief Executes a single command (no pipeline).
  *
  * Determines if the command is a builtin, package command, or external
- * command, and dispatches to the appropriate execution function.
+ * command, and dispatches to the appropriate execution function. Builtins
+ * started with `&` run detached on a thread, as a job of their own. Package
+ * commands are external binaries installed via the package manager and
+ * run from their registered path. Apps linked into jbox run like builtins
+ * when their output is not a terminal, and otherwise as a child running
+ * this same binary; so do jobs placed with `run`, whose settings apply
+ * to processes.
  *
  * @param job The execution job containing command and redirection info.
  * @return Exit status of the command.
@@ -583,195 +539,446 @@ static int jshell_exec_single_cmd(JShellExecJob* job) {
   JShellCmdParams* cmd_params =
     &job->jshell_cmd_vector_ptr->jshell_cmd_params_ptr[0];
 
-  const jshell_cmd_spec_t* cmd_spec = jshell_find_builtin(cmd_params->argv[0]);
+  const jshell_cmd_spec_t* cmd_spec = cmd_params->spec;
+  if (jshell_is_linked_command(cmd_spec)
+      && (jshell_sched_is_set(&job->sched)
+          || (job->output_stream == NULL
+              && !jshell_linked_runs_in_process(job->exec_job_type,
+                                                job->output_fd)))) {
+    DPRINT("Command is linked, running as child: %s", cmd_spec->name);
+    cmd_spec = NULL;
+  }
   if (cmd_spec != NULL) {
     if (cmd_spec->type == CMD_PACKAGE) {
-      DPRINT("Command is package: %s", cmd_spec->name);
-      return jshell_exec_package_cmd(cmd_spec, cmd_params, job);
+      DPRINT("Command is package: %s -> %s", cmd_spec->name,
+             cmd_spec->bin_path);
+      return jshell_spawn_and_wait(cmd_spec->bin_path, cmd_params, job);
+    }
+    if (job->exec_job_type == BG_JOB && cmd_spec->type == CMD_BUILTIN
+        && jshell_builtin_can_run_detached(cmd_spec->name)) {
+      char* cmd_string = jshell_build_cmd_string(job->jshell_cmd_vector_ptr);
+      int job_id = jshell_start_builtin_job(
+        cmd_spec, cmd_params->argc, cmd_params->argv, job->input_fd,
+        job->output_fd, cmd_string != NULL ? cmd_string : cmd_spec->name);
+      free(cmd_string);
+      if (job_id > 0) {
+        if (job->spool != NULL) {
+          jshell_job_set_spool(job_id, job->spool);
+          job->spool = NULL;
+        }
+        job->input_fd = -1;
+        job->output_fd = -1;
+        return 0;
+      }
     }
     DPRINT("Command is builtin: %s", cmd_spec->name);
-    return jshell_exec_builtin(cmd_spec, cmd_params,
-                                job->input_fd, job->output_fd);
+    int result = jshell_exec_builtin(cmd_spec, cmd_params,
+                                     job->input_fd, job->output_fd,
+                                     job->output_stream, job->stage_usage);
+    /* The builtin took ownership of the redirection descriptors */
+    job->input_fd = -1;
+    job->output_fd = -1;
+    return result;
   }
 
-  pid_t pid = fork();
-  if (pid == -1) {
-    perror("fork");
-    return -1;
+  char* exec_path = jshell_resolve_exec_path(cmd_params);
+  int result = jshell_spawn_and_wait(exec_path, cmd_params, job);
+  free(exec_path);
+
+  return result;
+}
+
+
+/**
+ * @brief Decides whether a pipeline stage runs on a thread in the shell.
+ *
+ * Only foreground pipelines use in-process stages, and only for builtins
+ * that do not exist to modify shell state; those keep subshell semantics
+ * by running outside the shell process. Apps linked into jbox run under
+ * their own jbox_ctx_t, so any number of them can share the pipeline
+ * with builtins; only a last stage writing to a terminal, or any stage of
+ * a job placed with `run`, runs as a child.
+ *
+ * @param spec Command spec for the stage, or NULL if not registered.
+ * @param job The execution job, for its type and redirections.
+ * @param last true for the stage that writes the pipeline's output.
+ * @return true if the stage should run via jshell_spawn_builtin_thread.
+ */
+static bool jshell_stage_runs_in_process(const jshell_cmd_spec_t* spec,
+                                         const JShellExecJob* job,
+                                         bool last) {
+  if (jshell_is_linked_command(spec)) {
+    /* Inner stages write to a pipe; `run` places processes, not threads */
+    return job->exec_job_type == FG_JOB
+           && !jshell_sched_is_set(&job->sched)
+           && (!last || job->output_stream != NULL
+               || jshell_linked_runs_in_process(job->exec_job_type,
+                                                job->output_fd));
+  }
+  return spec != NULL
+         && spec->type == CMD_BUILTIN
+         && spec->run != NULL
+         && job->exec_job_type == FG_JOB
+         && jshell_builtin_is_pipeline_safe(spec->name);
+}
+
+
+/**
+ * @brief Cancels stages of a running pipeline that nobody listens to.
+ *
+ * A forked stage whose reader went away dies of SIGPIPE; a stage on a
+ * thread has no such signal, so while any runs this watches the threads'
+ * completion eventfds and pidfds of the forked stages. Once a stage
+ * finishes, every stage upstream of it is cancelled, and SIGINT cancels
+ * them all. Nothing is reaped or consumed: the stages are waited for as
+ * usual afterwards.
+ *
+ * @param threads Thread of each stage, or NULL.
+ * @param pids Process of each stage, or 0.
+ * @param cancel Cancel flag of each stage.
+ * @param cmd_count Number of stages.
+ */
+static void jshell_watch_pipeline(JShellBuiltinThread** threads,
+                                  const pid_t* pids, atomic_bool* cancel,
+                                  size_t cmd_count) {
+  size_t running = 0;
+  for (size_t i = 0; i < cmd_count; i++) {
+    running += threads[i] != NULL;
+  }
+  /* Cancelling only helps threads upstream of another stage */
+  if (running == 0 || (running == 1 && threads[cmd_count - 1] != NULL)) {
+    return;
+  }
+
+  struct pollfd* fds = calloc(cmd_count, sizeof(struct pollfd));
+  if (fds == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < cmd_count; i++) {
+    fds[i].events = POLLIN;
+    if (threads[i] != NULL) {
+      fds[i].fd = jshell_builtin_thread_fd(threads[i]);
+    } else if (pids[i] > 0) {
+      fds[i].fd = jshell_open_pidfd(pids[i]);
+    } else {
+      fds[i].fd = -1;
+    }
   }
-  
-  if (pid == 0) {
-    /* Reset signal handlers to default for child process */
-    jshell_reset_signals_for_child();
 
-    if (jshell_setup_input_redir(job->input_fd) == -1) {
-      exit(EXIT_FAILURE);
+  /* A finished stage no longer reads its input, so every stage upstream
+   * of it is cancelled; cancelled counts the leading stages whose output
+   * nobody can read any more */
+  size_t cancelled = 0;
+  while (running > 0) {
+    if (jshell_is_interrupted()) {
+      cancelled = cmd_count;
+    }
+    for (size_t i = 0; i < cancelled; i++) {
+      atomic_store(&cancel[i], true);
+    }
+    if (cancelled == cmd_count) {
+      break;
     }
 
-    if (jshell_setup_output_redir(job->output_fd) == -1) {
-      exit(EXIT_FAILURE);
+    if (poll(fds, cmd_count, JSHELL_RING_CANCEL_POLL_MS) == -1) {
+      if (errno != EINTR) {
+        break;
+      }
+      continue;
     }
 
-    char* resolved_path = jshell_resolve_command(cmd_params->argv[0]);
-    if (resolved_path != NULL) {
-      execv(resolved_path, cmd_params->argv);
-      if (errno == EACCES) {
-        fprintf(stderr, "jshell: %s: Permission denied\n",
-                cmd_params->argv[0]);
-        free(resolved_path);
-        exit(126);
+    for (size_t i = 0; i < cmd_count; i++) {
+      if (fds[i].fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP))) {
+        continue;
       }
-      fprintf(stderr, "jshell: %s: %s\n", cmd_params->argv[0],
-              strerror(errno));
-      free(resolved_path);
-      exit(127);
-    } else {
-      execvp(cmd_params->argv[0], cmd_params->argv);
-      if (errno == EACCES) {
-        fprintf(stderr, "jshell: %s: Permission denied\n",
-                cmd_params->argv[0]);
-        exit(126);
-      } else if (errno == ENOENT) {
-        fprintf(stderr, "jshell: %s: command not found\n",
-                cmd_params->argv[0]);
+      DPRINT("Pipeline stage %zu finished, cancelling upstream", i);
+      if (threads[i] != NULL) {
+        running--;
       } else {
-        fprintf(stderr, "jshell: %s: %s\n", cmd_params->argv[0],
-                strerror(errno));
+        close(fds[i].fd);
+      }
+      fds[i].fd = -1;
+      if (i > cancelled) {
+        cancelled = i;
       }
     }
-    exit(127);
   }
 
-  if (job->input_fd != -1) {
-    close(job->input_fd);
-  }
-  if (job->output_fd != -1) {
-    close(job->output_fd);
-  }
-  
-  if (job->exec_job_type == BG_JOB) {
-    char* cmd_string = jshell_build_cmd_string(job->jshell_cmd_vector_ptr);
-    jshell_add_background_job(&pid, 1, cmd_string);
-    if (cmd_string != NULL) {
-      free(cmd_string);
+  for (size_t i = 0; i < cmd_count; i++) {
+    if (fds[i].fd >= 0 && threads[i] == NULL) {
+      close(fds[i].fd);
     }
   }
-  
-  return jshell_wait_for_jobs(&pid, 1, job->exec_job_type);
+  free(fds);
 }
 
 
 /**
  * @brief Executes a command pipeline.
  *
- * Creates pipes, forks processes for each command in the pipeline,
- * connects them via pipes, and waits for completion.
+ * Builtin stages run concurrently on threads inside the shell, each with
+ * its own JShellIO streams, and external stages are launched with
+ * jshell_spawn_command. External stages are started before the builtin
+ * threads so that a fork() fallback never races with a thread that is
+ * still setting up its streams. A stage that cannot be launched reports
+ * its error and exits 126/127 without tearing down the rest. Threaded
+ * stages get a cancel flag that is set once nothing downstream reads
+ * their output any more, or on SIGINT.
  *
  * @param job The execution job containing pipeline commands.
  * @return Exit status of the last command in the pipeline.
  */
 static int jshell_exec_pipeline(JShellExecJob* job) {
-  DPRINT("jshell_exec_pipeline called with %zu commands", 
+  DPRINT("jshell_exec_pipeline called with %zu commands",
          job->jshell_cmd_vector_ptr->cmd_count);
-  
+
   size_t cmd_count = job->jshell_cmd_vector_ptr->cmd_count;
   size_t pipe_count = cmd_count - 1;
-  
-  int** pipes = jshell_create_pipes(pipe_count);
-  if (pipes == NULL) {
+  JShellCmdParams* stages = job->jshell_cmd_vector_ptr->jshell_cmd_params_ptr;
+
+  bool* in_process = calloc(cmd_count, sizeof(bool));
+  pid_t* pids = calloc(cmd_count, sizeof(pid_t));
+  JShellBuiltinThread** threads = calloc(cmd_count, sizeof(*threads));
+  int* statuses = calloc(cmd_count, sizeof(int));
+  atomic_bool* cancel = calloc(cmd_count, sizeof(atomic_bool));
+  if (in_process == NULL || pids == NULL || threads == NULL
+      || statuses == NULL || cancel == NULL) {
+    perror("calloc pipeline state");
+    free(in_process);
+    free(pids);
+    free(threads);
+    free(statuses);
+    free(cancel);
     return -1;
   }
-  
-  pid_t* pids = malloc(sizeof(pid_t) * cmd_count);
-  if (pids == NULL) {
-    perror("malloc pids");
-    jshell_close_pipes(pipes, pipe_count);
+
+  for (size_t i = 0; i < cmd_count; i++) {
+    statuses[i] = 127;
+    in_process[i] = jshell_stage_runs_in_process(stages[i].spec, job,
+                                                 i == cmd_count - 1);
+  }
+
+  JShellPipe* pipes = jshell_create_pipes(pipe_count, stages, in_process);
+  if (pipes == NULL) {
+    free(in_process);
+    free(pids);
+    free(threads);
+    free(statuses);
+    free(cancel);
     return -1;
   }
-  
+
+  int result = -1;
+
   for (size_t i = 0; i < cmd_count; i++) {
-    JShellCmdParams* cmd_params = 
-      &job->jshell_cmd_vector_ptr->jshell_cmd_params_ptr[i];
-    
-    const jshell_cmd_spec_t* builtin = 
-      jshell_find_builtin(cmd_params->argv[0]);
-    
-    if (builtin != NULL && cmd_count == 1) {
-      DPRINT("Single builtin command in pipeline: %s", builtin->name);
-      int result = jshell_exec_builtin(builtin, cmd_params,
-                                        job->input_fd, job->output_fd);
-      free(pids);
-      jshell_close_pipes(pipes, pipe_count);
-      return result;
+    if (in_process[i]) {
+      continue;
     }
-    
-    pid_t pid = jshell_fork_and_exec(cmd_params, pipes, i, cmd_count,
-                                      job->input_fd, job->output_fd);
+
+    char* exec_path = jshell_resolve_exec_path(&stages[i]);
+    pid_t pid = jshell_spawn_stage(&stages[i], exec_path, pipes, i,
+                                   cmd_count, job->input_fd,
+                                   job->output_fd, &statuses[i]);
+    free(exec_path);
     if (pid == -1) {
-      for (size_t j = 0; j < i; j++) {
-        kill(pids[j], SIGTERM);
-      }
-      free(pids);
-      jshell_close_pipes(pipes, pipe_count);
-      return -1;
+      /* Its pipe ends are closed below, so neighbours see EOF/EPIPE */
+      continue;
     }
-    
+
+    jshell_sched_apply(&job->sched, pid);
     pids[i] = pid;
   }
-  
+
+  for (size_t i = 0; i < cmd_count; i++) {
+    if (!in_process[i]) {
+      continue;
+    }
+
+    int* input_fd = (i == 0) ? &job->input_fd : &pipes[i - 1].read_fd;
+    int* output_fd = (i == cmd_count - 1) ? &job->output_fd
+                                          : &pipes[i].write_fd;
+    JShellRing* no_ring = NULL;
+    JShellRing** input_ring = (i == 0) ? &no_ring : &pipes[i - 1].read_ring;
+    JShellRing** output_ring = (i == cmd_count - 1) ? &no_ring
+                                                    : &pipes[i].write_ring;
+
+    JShellStageIO io = {
+      .input_fd = *input_fd,
+      .input_ring = *input_ring,
+      .output_fd = *output_fd,
+      .output_ring = *output_ring,
+      .output_stream = (i == cmd_count - 1) ? job->output_stream : NULL,
+      .records_out = jshell_link_carries_records(stages, in_process, i,
+                                                 cmd_count),
+      .cancel = &cancel[i],
+    };
+    threads[i] = jshell_spawn_builtin_stage(stages[i].spec, stages[i].argc,
+                                            stages[i].argv, &io);
+    if (threads[i] == NULL) {
+      /* Its pipe ends are closed below, so neighbours see EOF/EPIPE */
+      fprintf(stderr, "jshell: %s: could not start builtin thread\n",
+              stages[i].spec->name);
+      continue;
+    }
+
+    /* The thread now owns these descriptors and rings */
+    *input_fd = -1;
+    *output_fd = -1;
+    *input_ring = NULL;
+    *output_ring = NULL;
+  }
+
   if (job->input_fd != -1) {
     close(job->input_fd);
+    job->input_fd = -1;
   }
   if (job->output_fd != -1) {
     close(job->output_fd);
+    job->output_fd = -1;
   }
-  
+
   jshell_close_pipes(pipes, pipe_count);
-  
+
   if (job->exec_job_type == BG_JOB) {
+    /* Background pipelines have no threads; drop stages that never ran */
+    size_t spawned = 0;
+    for (size_t i = 0; i < cmd_count; i++) {
+      if (pids[i] > 0) {
+        pids[spawned++] = pids[i];
+      }
+    }
     char* cmd_string = jshell_build_cmd_string(job->jshell_cmd_vector_ptr);
-    jshell_add_background_job(pids, cmd_count, cmd_string);
+    if (spawned > 0) {
+      int job_id =
+        jshell_add_background_job(pids, spawned, cmd_string, &job->sched);
+      if (job->spool != NULL) {
+        jshell_job_set_spool(job_id, job->spool);
+        job->spool = NULL;
+      }
+    }
     if (cmd_string != NULL) {
       free(cmd_string);
     }
+    result = 0;
+    goto out;
   }
-  
-  int result = jshell_wait_for_jobs(pids,cmd_count, job->exec_job_type);
+
+  jshell_watch_pipeline(threads, pids, cancel, cmd_count);
+
+  for (size_t i = 0; i < cmd_count; i++) {
+    int status;
+    JShellUsage* usage = job->stage_usage != NULL ? &job->stage_usage[i]
+                                                  : NULL;
+    if (threads[i] != NULL) {
+      status = jshell_wait_builtin_thread(threads[i]);
+      if (usage != NULL) {
+        *usage = threads[i]->usage;
+      }
+      jshell_free_builtin_thread(threads[i]);
+    } else if (pids[i] > 0) {
+      status = jshell_wait_for_jobs(&pids[i], 1, FG_JOB, usage,
+                                    job->time_start);
+    } else {
+      status = statuses[i];
+    }
+    if (i == cmd_count - 1) {
+      result = status;
+    }
+  }
+
+out:
+  free(in_process);
   free(pids);
-  
+  free(threads);
+  free(statuses);
+  free(cancel);
+
   return result;
 }
 
 
 /**
- * @brief Executes a job (single command or pipeline).
- *
- * Main entry point for job execution. Handles both single commands and
- * pipelines, updates exit status, and refreshes package commands if needed.
- *
- * @param job The execution job to run.
- * @return Exit status of the job.
+ * @brief Writes the words of a stage as one JSON string.
+ * @param out Output stream.
+ * @param cmd_params The stage.
  */
-int jshell_exec_job(JShellExecJob* job) {
-  DPRINT("jshell_exec_job called");
-
-  if (job == NULL || job->jshell_cmd_vector_ptr == NULL) {
-    return -1;
+static void jshell_write_stage_json(FILE* out,
+                                    const JShellCmdParams* cmd_params) {
+  fputc('"', out);
+  for (int i = 0; i < cmd_params->argc; i++) {
+    if (i > 0) {
+      fputc(' ', out);
+    }
+    jbox_json_write_escaped(out, cmd_params->argv[i],
+                            strlen(cmd_params->argv[i]));
   }
+  fputc('"', out);
+}
 
-  DPRINT("Job type: %d, cmd_count: %zu",
-         job->exec_job_type,
-         job->jshell_cmd_vector_ptr->cmd_count);
 
-  // Check if the first command is "pkg" (for refreshing packages after)
-  int is_pkg_cmd = 0;
-  if (job->jshell_cmd_vector_ptr->cmd_count > 0) {
-    JShellCmdParams* first_cmd =
-      &job->jshell_cmd_vector_ptr->jshell_cmd_params_ptr[0];
-    if (first_cmd->argc > 0 && first_cmd->argv[0] != NULL) {
-      is_pkg_cmd = (strcmp(first_cmd->argv[0], "pkg") == 0);
+/**
+ * @brief Prints a usage line for a timed job or one of its stages.
+ * @param label What the usage is of.
+ * @param usage The usage.
+ */
+static void jshell_print_usage_line(const char* label,
+                                    const JShellUsage* usage) {
+  fprintf(stderr, "%-12s real %.3fs  user %.3fs  sys %.3fs  maxrss %ldK\n",
+          label, (double)usage->wall_us / 1e6, (double)usage->user_us / 1e6,
+          (double)usage->sys_us / 1e6, usage->max_rss_kb);
+}
+
+
+/**
+ * @brief Reports the usage of a job run with the `time` prefix.
+ *
+ * Goes to stderr so the command's own output is left alone. The totals
+ * add up the CPU time of all stages and keep their largest peak memory;
+ * stages run at the same time, so their wall times overlap. A pipeline
+ * also gets one entry per stage.
+ *
+ * @param job The timed job.
+ * @param status Exit status of the job.
+ */
+static void jshell_report_job_time(const JShellExecJob* job, int status) {
+  size_t cmd_count = job->jshell_cmd_vector_ptr->cmd_count;
+  JShellCmdParams* stages = job->jshell_cmd_vector_ptr->jshell_cmd_params_ptr;
+
+  JShellUsage total = {0};
+  for (size_t i = 0; i < cmd_count; i++) {
+    jshell_usage_add(&total, &job->stage_usage[i]);
+  }
+  total.wall_us = jshell_usage_now() - job->time_start;
+
+  if (job->time_mode == TIME_JSON) {
+    fprintf(stderr, "{\"status\": %d, ", status);
+    jshell_usage_write_json(stderr, &total);
+    fputs(", \"stages\": [", stderr);
+    for (size_t i = 0; i < cmd_count; i++) {
+      fputs(i > 0 ? ", {\"command\": " : "{\"command\": ", stderr);
+      jshell_write_stage_json(stderr, &stages[i]);
+      fputs(", ", stderr);
+      jshell_usage_write_json(stderr, &job->stage_usage[i]);
+      fputc('}', stderr);
     }
+    fputs("]}\n", stderr);
+    return;
+  }
+
+  jshell_print_usage_line("total", &total);
+  for (size_t i = 0; cmd_count > 1 && i < cmd_count; i++) {
+    jshell_print_usage_line(stages[i].argv[0], &job->stage_usage[i]);
   }
+}
+
+
+/**
+ * @brief Runs the stages of a job and reports their usage if timed.
+ * @param job The execution job.
+ * @return Exit status of the job.
+ */
+static int jshell_run_stages(JShellExecJob* job) {
+  job->time_start = jshell_usage_now();
 
   int result;
   if (job->jshell_cmd_vector_ptr->cmd_count == 1) {
@@ -780,6 +987,134 @@ int jshell_exec_job(JShellExecJob* job) {
     result = jshell_exec_pipeline(job);
   }
 
+  if (job->time_mode != TIME_OFF) {
+    jshell_report_job_time(job, result);
+  }
+  return result;
+}
+
+
+/**
+ * @brief Sends a background job's output to a spool instead of the terminal.
+ *
+ * Only jobs whose output is not redirected are spooled, and only while
+ * JSHELL_JOB_OUTPUT is not 0. The job table entry takes the spool once
+ * the job is added; the job writes into its pipe until then.
+ *
+ * @param job The background job, before its stages start.
+ */
+static void jshell_spool_job_output(JShellExecJob* job) {
+  size_t size = jshell_spool_size();
+  if (size == 0) {
+    return;
+  }
+  int write_fd;
+  job->spool = jshell_spool_open(size, &write_fd);
+  if (job->spool == NULL) {
+    perror("jshell: job output");
+    return;
+  }
+  job->output_fd = write_fd;
+}
+
+
+/**
+ * @brief Prints the output of a spool no job table entry took.
+ *
+ * Happens when a background command ran to completion on the shell's
+ * thread instead, or failed to start.
+ *
+ * @param job The job whose stages have finished.
+ */
+static void jshell_flush_job_spool(JShellExecJob* job) {
+  jshell_spool_wait(job->spool, 100);
+  size_t len = 0;
+  char* data = jshell_spool_read(job->spool, &len, NULL, NULL);
+  if (data != NULL) {
+    fwrite(data, 1, len, stdout);
+    fflush(stdout);
+    free(data);
+  }
+  jshell_spool_free(job->spool);
+  job->spool = NULL;
+}
+
+
+/**
+ * @brief Tells whether a job's output may come from the result cache.
+ *
+ * Only a lone foreground command with a cache_scope qualifies, reading
+ * no redirected input and writing to a file or pipe: a terminal would see
+ * the output formatted for a pipe. Timed jobs and jobs placed with `run`
+ * always run.
+ *
+ * @param job The execution job, before its stages start.
+ * @return true if the job goes through jshell_run_cached().
+ */
+static bool jshell_job_uses_result_cache(const JShellExecJob* job) {
+  if (job->jshell_cmd_vector_ptr->cmd_count != 1) {
+    return false;
+  }
+  const jshell_cmd_spec_t* spec =
+    job->jshell_cmd_vector_ptr->jshell_cmd_params_ptr[0].spec;
+  return spec != NULL && spec->cache_scope != NULL && spec->run != NULL
+         && job->exec_job_type == FG_JOB && job->input_fd == -1
+         && job->output_stream == NULL && job->time_mode == TIME_OFF
+         && !jshell_sched_is_set(&job->sched)
+         && !isatty(job->output_fd != -1 ? job->output_fd : STDOUT_FILENO)
+         && jshell_result_cache_size() > 0;
+}
+
+
+static int jshell_run_cached(JShellExecJob* job);
+
+
+/**
+ * @brief Executes a job (single command or pipeline).
+ *
+ * Main entry point for job execution. Handles both single commands and
+ * pipelines, updates exit status, and refreshes package commands if needed.
+ * Background jobs printing to the terminal have their output spooled.
+ *
+ * @param job The execution job to run.
+ * @return Exit status of the job.
+ */
+int jshell_exec_job(JShellExecJob* job) {
+  DPRINT("jshell_exec_job called");
+
+  if (job == NULL || job->jshell_cmd_vector_ptr == NULL) {
+    return -1;
+  }
+
+  DPRINT("Job type: %d, cmd_count: %zu",
+         job->exec_job_type,
+         job->jshell_cmd_vector_ptr->cmd_count);
+
+  // Check if the first command is "pkg" (for refreshing packages after)
+  int is_pkg_cmd = 0;
+  if (job->jshell_cmd_vector_ptr->cmd_count > 0) {
+    JShellCmdParams* first_cmd =
+      &job->jshell_cmd_vector_ptr->jshell_cmd_params_ptr[0];
+    if (first_cmd->argc > 0 && first_cmd->argv[0] != NULL) {
+      is_pkg_cmd = (strcmp(first_cmd->argv[0], "pkg") == 0);
+    }
+  }
+
+  if (job->exec_job_type == BG_JOB && job->output_fd == -1
+      && job->output_stream == NULL) {
+    jshell_spool_job_output(job);
+  }
+
+  uint64_t trace_start = jshell_trace_begin();
+  int result = jshell_job_uses_result_cache(job) ? jshell_run_cached(job)
+                                                 : jshell_run_stages(job);
+  jshell_trace_end(job->jshell_cmd_vector_ptr->cmd_count == 1
+                   ? "command" : "pipeline", NULL, trace_start);
+
+  if (job->spool != NULL) {
+    jshell_flush_job_spool(job);
+  }
+
   jshell_set_last_exit_status(result);
 
   // If pkg command was run, refresh package registrations
@@ -798,224 +1133,395 @@ int jshell_exec_job(JShellExecJob* job) {
 
 
 /**
- * @brief Captures command output while also displaying it (tee behavior).
- *
- * Executes a job and captures its stdout output into a buffer while
- * simultaneously displaying it. Used for variable assignment from commands.
+ * @brief State shared with the capture thread of a command substitution.
+ */
+typedef struct {
+  int read_fd;        /**< Read end of the capture pipe. */
+  int tee_fd;         /**< Where captured output is echoed. */
+  char* data;         /**< Captured bytes, NUL-terminated when done. */
+  size_t len;         /**< Number of bytes captured. */
+  size_t cap;         /**< Allocated size of data. */
+  bool truncated;     /**< True once MAX_CAPTURE_SIZE was reached. */
+} JShellCapture;
+
+
+/**
+ * @brief Writes a whole buffer, retrying on short writes and EINTR.
  *
- * @param job The execution job to run and capture.
- * @return Allocated string with captured output, or NULL on error.
+ * @param fd Destination descriptor.
+ * @param buf Bytes to write.
+ * @param len Number of bytes.
+ * @return 0 on success, -1 on error.
  */
-char* jshell_capture_and_tee_output(JShellExecJob* job) {
-  DPRINT("jshell_capture_and_tee_output called");
-  
-  if (job == NULL || job->jshell_cmd_vector_ptr == NULL) {
-    return NULL;
+static int jshell_write_all(int fd, const char* buf, size_t len) {
+  while (len > 0) {
+    ssize_t written = write(fd, buf, len);
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    buf += written;
+    len -= (size_t)written;
   }
-  
-  int capture_pipe[2];
-  if (pipe(capture_pipe) == -1) {
-    perror("pipe for capture");
-    return NULL;
+  return 0;
+}
+
+
+/**
+ * @brief Makes room for at least one more read in the capture buffer.
+ *
+ * Grows the buffer geometrically, never beyond MAX_CAPTURE_SIZE plus the
+ * terminating NUL.
+ *
+ * @param capture The capture state.
+ * @return Number of bytes that can be read into the buffer, 0 if the cap
+ *         has been reached or memory ran out.
+ */
+static size_t jshell_capture_reserve(JShellCapture* capture) {
+  if (capture->cap - capture->len > CAPTURE_READ_SIZE) {
+    return capture->cap - capture->len - 1;
   }
-  
-  int buffer_pipe[2];
-  if (pipe(buffer_pipe) == -1) {
-    perror("pipe for buffer");
-    close(capture_pipe[0]);
-    close(capture_pipe[1]);
-    return NULL;
+  if (capture->cap >= MAX_CAPTURE_SIZE + 1) {
+    return capture->cap - capture->len - 1;
   }
-  
-  int original_output_fd = job->output_fd;
-  if (original_output_fd == -1) {
-    original_output_fd = dup(STDOUT_FILENO);
-    if (original_output_fd == -1) {
-      perror("dup stdout");
-      close(capture_pipe[0]);
-      close(capture_pipe[1]);
-      close(buffer_pipe[0]);
-      close(buffer_pipe[1]);
-      return NULL;
-    }
+
+  size_t new_cap = capture->cap * 2;
+  if (new_cap > MAX_CAPTURE_SIZE + 1) {
+    new_cap = MAX_CAPTURE_SIZE + 1;
   }
-  
-  pid_t tee_pid = fork();
-  if (tee_pid == -1) {
-    perror("fork tee process");
-    close(capture_pipe[0]);
-    close(capture_pipe[1]);
-    close(buffer_pipe[0]);
-    close(buffer_pipe[1]);
-    if (job->output_fd == -1) {
-      close(original_output_fd);
-    }
-    return NULL;
+  char* grown = realloc(capture->data, new_cap);
+  if (grown == NULL) {
+    perror("realloc capture buffer");
+    return capture->cap - capture->len - 1;
   }
-  
-  if (tee_pid == 0) {
-    /* Reset signal handlers to default for child process */
-    jshell_reset_signals_for_child();
+  capture->data = grown;
+  capture->cap = new_cap;
+  return capture->cap - capture->len - 1;
+}
 
-    close(capture_pipe[1]);
-    close(buffer_pipe[0]);
 
-    char* buffer = malloc(MAX_VAR_SIZE);
-    if (buffer == NULL) {
-      perror("malloc capture buffer in tee");
-      exit(EXIT_FAILURE);
+/**
+ * @brief Capture thread: tees the command's output and keeps a copy.
+ *
+ * Reads straight into the growing capture buffer; once the cap is reached
+ * the rest of the output is still echoed but no longer stored.
+ *
+ * @param arg Pointer to the JShellCapture state.
+ * @return NULL.
+ */
+static void* jshell_capture_thread_entry(void* arg) {
+  JShellCapture* capture = arg;
+  char overflow[CAPTURE_READ_SIZE];
+
+  for (;;) {
+    size_t room = jshell_capture_reserve(capture);
+    char* dest = (room > 0) ? capture->data + capture->len : overflow;
+    size_t want = (room > 0) ? room : sizeof(overflow);
+
+    ssize_t bytes_read = read(capture->read_fd, dest, want);
+    if (bytes_read == -1 && errno == EINTR) {
+      continue;
     }
-    memset(buffer, 0, MAX_VAR_SIZE);
-    
-    char tee_buffer[4096];
-    ssize_t bytes_read;
-    size_t total_captured = 0;
-    
-    while ((bytes_read = read(capture_pipe[0], tee_buffer, 
-                               sizeof(tee_buffer))) > 0) {
-      if (write(original_output_fd, tee_buffer, bytes_read) == -1) {
-        perror("write to output");
-      }
-      
-      size_t to_copy = (size_t)bytes_read;
-      if (total_captured + to_copy >= MAX_VAR_SIZE) {
-        to_copy = MAX_VAR_SIZE - total_captured - 1;
-      }
-      
-      if (to_copy > 0) {
-        memcpy(buffer + total_captured, tee_buffer, to_copy);
-        total_captured += to_copy;
-      }
-      
-      if (total_captured >= MAX_VAR_SIZE - 1) {
-        while ((bytes_read = read(capture_pipe[0], tee_buffer, 
-                                   sizeof(tee_buffer))) > 0) {
-          if (write(original_output_fd, tee_buffer, bytes_read) == -1) {
-            perror("write to output");
-          }
-        }
-        break;
-      }
+    if (bytes_read <= 0) {
+      break;
     }
-    
-    buffer[total_captured] = '\0';
-    
-    size_t buffer_len = strlen(buffer) + 1;
-    if (write(buffer_pipe[1], &buffer_len, sizeof(size_t)) == -1) {
-      perror("write buffer length");
+
+    if (jshell_write_all(capture->tee_fd, dest, (size_t)bytes_read) == -1) {
+      perror("write to output");
     }
-    
-    if (write(buffer_pipe[1], buffer, buffer_len) == -1) {
-      perror("write buffer content");
+
+    if (room > 0) {
+      capture->len += (size_t)bytes_read;
+    } else {
+      capture->truncated = true;
     }
-    
-    free(buffer);
-    close(capture_pipe[0]);
-    close(buffer_pipe[1]);
-    if (job->output_fd == -1) {
-      close(original_output_fd);
+  }
+
+  capture->data[capture->len] = '\0';
+  return NULL;
+}
+
+
+/**
+ * @brief Stream write callback of an in-memory capture.
+ *
+ * Runs on the thread of the command being captured: appends to the
+ * capture buffer up to MAX_CAPTURE_SIZE and echoes everything to the tee
+ * descriptor, so the shell does the tee without a pipe in between.
+ *
+ * @param cookie The JShellCapture state.
+ * @param buf Bytes written by the command.
+ * @param size Number of bytes.
+ * @return size; output is never refused.
+ */
+static ssize_t jshell_capture_stream_write(void* cookie, const char* buf,
+                                           size_t size) {
+  JShellCapture* capture = cookie;
+
+  size_t done = 0;
+  while (done < size && !capture->truncated) {
+    size_t room = jshell_capture_reserve(capture);
+    if (room == 0) {
+      capture->truncated = true;
+      break;
     }
-    
-    exit(EXIT_SUCCESS);
+    size_t count = size - done < room ? size - done : room;
+    memcpy(capture->data + capture->len, buf + done, count);
+    capture->len += count;
+    done += count;
   }
-  
-  close(capture_pipe[0]);
-  close(buffer_pipe[1]);
-  
+
+  if (jshell_write_all(capture->tee_fd, buf, size) == -1) {
+    perror("write to output");
+  }
+  return (ssize_t)size;
+}
+
+
+/**
+ * @brief Tells whether the last stage of a job can write into a stream.
+ *
+ * That is the case when it runs on a thread of the shell with JShellIO
+ * streams: a builtin that need not run on the main thread (and, inside a
+ * pipeline, is pipeline safe), or a linked app that never writes to its
+ * output descriptor directly. Only foreground jobs qualify.
+ *
+ * @param job The execution job.
+ * @return true if the job may be given an output_stream.
+ */
+static bool jshell_job_can_write_stream(const JShellExecJob* job) {
+  size_t cmd_count = job->jshell_cmd_vector_ptr->cmd_count;
+  const jshell_cmd_spec_t* spec =
+    job->jshell_cmd_vector_ptr->jshell_cmd_params_ptr[cmd_count - 1].spec;
+
+  if (job->exec_job_type != FG_JOB || spec == NULL || spec->run == NULL) {
+    return false;
+  }
+  if (jshell_is_linked_command(spec)) {
+    return jshell_linked_writes_stream_only(spec);
+  }
+  return spec->type == CMD_BUILTIN
+         && !jshell_builtin_requires_main_thread(spec->name)
+         && (cmd_count == 1 || jshell_builtin_is_pipeline_safe(spec->name));
+}
+
+
+/**
+ * @brief Runs a job whose last stage writes straight into the capture.
+ * @param job The execution job.
+ * @param capture The capture state, with its buffer and tee descriptor.
+ * @param status Set to the exit status of the job.
+ * @return false if the stream could not be made and nothing ran.
+ */
+static bool jshell_capture_in_memory(JShellExecJob* job,
+                                     JShellCapture* capture, int* status) {
+  cookie_io_functions_t funcs = {
+    .write = jshell_capture_stream_write,
+  };
+  FILE* stream = fopencookie(capture, "w", funcs);
+  if (stream == NULL) {
+    perror("fopencookie capture");
+    return false;
+  }
+
+  int saved_output_fd = job->output_fd;
+  job->output_fd = -1;
+  job->output_stream = stream;
+
+  *status = jshell_run_stages(job);
+
+  job->output_stream = NULL;
+  job->output_fd = saved_output_fd;
+  fclose(stream);
+  return true;
+}
+
+
+/**
+ * @brief Runs a job writing into a pipe drained by a capture thread.
+ * @param job The execution job.
+ * @param capture The capture state, with its buffer and tee descriptor.
+ * @param status Set to the exit status of the job.
+ * @return false if the pipe or thread could not be made and nothing ran.
+ */
+static bool jshell_capture_through_pipe(JShellExecJob* job,
+                                        JShellCapture* capture,
+                                        int* status) {
+  int capture_pipe[2];
+  if (pipe2(capture_pipe, O_CLOEXEC) == -1) {
+    perror("pipe for capture");
+    return false;
+  }
+  capture->read_fd = capture_pipe[0];
+
+  pthread_t capture_thread;
+  if (pthread_create(&capture_thread, NULL, jshell_capture_thread_entry,
+                     capture) != 0) {
+    perror("pthread_create capture");
+    close(capture_pipe[0]);
+    close(capture_pipe[1]);
+    return false;
+  }
+
   int saved_output_fd = job->output_fd;
   job->output_fd = capture_pipe[1];
-  
-  int result;
-  if (job->jshell_cmd_vector_ptr->cmd_count == 1) {
-    result = jshell_exec_single_cmd(job);
-  } else {
-    result = jshell_exec_pipeline(job);
+
+  *status = jshell_run_stages(job);
+
+  /* Normally consumed by the command; close it if an error left it here */
+  if (job->output_fd != -1) {
+    close(job->output_fd);
   }
-  
-  close(capture_pipe[1]);
-  
-  int tee_status;
-  if (waitpid(tee_pid, &tee_status, 0) == -1) {
-    perror("waitpid tee process");
-    close(buffer_pipe[0]);
-    job->output_fd = saved_output_fd;
-    if (saved_output_fd == -1) {
-      close(original_output_fd);
+  job->output_fd = saved_output_fd;
+
+  pthread_join(capture_thread, NULL);
+  close(capture_pipe[0]);
+  return true;
+}
+
+
+/**
+ * @brief Runs a job through the result cache.
+ *
+ * A valid entry is written out without running anything. Otherwise the
+ * inputs are watched, the command runs with its output captured and
+ * echoed as for a command substitution, and the output is kept unless an
+ * input changed meanwhile. Output over MAX_CAPTURE_SIZE is not kept.
+ *
+ * @param job The execution job, accepted by jshell_job_uses_result_cache().
+ * @return Exit status of the job.
+ */
+static int jshell_run_cached(JShellExecJob* job) {
+  JShellCmdParams* cmd_params =
+    &job->jshell_cmd_vector_ptr->jshell_cmd_params_ptr[0];
+  const jshell_cmd_spec_t* spec = cmd_params->spec;
+
+  char* output;
+  size_t len;
+  int status;
+  if (jshell_result_cache_lookup(spec, cmd_params->argc, cmd_params->argv,
+                                 &output, &len, &status)) {
+    DPRINT("Result cache hit for %s", spec->name);
+    int out_fd = job->output_fd != -1 ? job->output_fd : STDOUT_FILENO;
+    fflush(stdout);
+    if (jshell_write_all(out_fd, output, len) == -1) {
+      perror("write to output");
     }
-    return NULL;
+    free(output);
+    return status;
   }
-  
-  size_t buffer_len = 0;
-  ssize_t read_result = read(buffer_pipe[0], &buffer_len, sizeof(size_t));
-  if (read_result != sizeof(size_t)) {
-    perror("read buffer length");
-    close(buffer_pipe[0]);
-    job->output_fd = saved_output_fd;
-    if (saved_output_fd == -1) {
-      close(original_output_fd);
-    }
+
+  JShellResultFill* fill = jshell_result_cache_begin(spec, cmd_params->argc,
+                                                     cmd_params->argv);
+  if (fill == NULL) {
+    return jshell_run_stages(job);
+  }
+
+  JShellCapture capture = {0};
+  capture.cap = CAPTURE_INITIAL_SIZE;
+  capture.data = malloc(capture.cap);
+  bool own_tee_fd = (job->output_fd == -1);
+  capture.tee_fd = own_tee_fd ? fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0)
+                              : job->output_fd;
+  if (capture.data == NULL || capture.tee_fd == -1) {
+    free(capture.data);
+    jshell_result_cache_commit(fill, NULL, 0, -1);
+    return jshell_run_stages(job);
+  }
+
+  fflush(stdout);
+  int result = 0;
+  bool ran = jshell_job_can_write_stream(job)
+             ? jshell_capture_in_memory(job, &capture, &result)
+             : jshell_capture_through_pipe(job, &capture, &result);
+  if (own_tee_fd) {
+    close(capture.tee_fd);
+  }
+  jshell_result_cache_commit(fill, capture.data, capture.len,
+                             ran && !capture.truncated ? result : -1);
+  free(capture.data);
+  return ran ? result : jshell_run_stages(job);
+}
+
+
+/**
+ * @brief Captures command output while also displaying it (tee behavior).
+ *
+ * Executes a job and captures its stdout output into a buffer while
+ * simultaneously displaying it. Used for variable assignment from commands.
+ * When the last stage runs on a shell thread it writes straight into the
+ * buffer through a stream, which also echoes the output; otherwise the
+ * output goes through a pipe drained by a thread in the shell. Either way
+ * no extra process is needed, output of any size keeps flowing, and up to
+ * MAX_CAPTURE_SIZE bytes are kept.
+ *
+ * @param job The execution job to run and capture.
+ * @return Allocated string with captured output, or NULL on error.
+ */
+char* jshell_capture_and_tee_output(JShellExecJob* job) {
+  DPRINT("jshell_capture_and_tee_output called");
+
+  if (job == NULL || job->jshell_cmd_vector_ptr == NULL) {
     return NULL;
   }
-  
-  if (buffer_len == 0 || buffer_len > MAX_VAR_SIZE) {
-    DPRINT("Invalid buffer length: %zu", buffer_len);
-    close(buffer_pipe[0]);
-    job->output_fd = saved_output_fd;
-    if (saved_output_fd == -1) {
-      close(original_output_fd);
-    }
+
+  uint64_t trace_start = jshell_trace_begin();
+  JShellCapture capture = {0};
+  capture.cap = CAPTURE_INITIAL_SIZE;
+  capture.data = malloc(capture.cap);
+  if (capture.data == NULL) {
+    perror("malloc capture buffer");
     return NULL;
   }
-  
-  char* buffer = malloc(buffer_len);
-  if (buffer == NULL) {
-    perror("malloc buffer in parent");
-    close(buffer_pipe[0]);
-    job->output_fd = saved_output_fd;
-    if (saved_output_fd == -1) {
-      close(original_output_fd);
-    }
+
+  /* Duplicate stdout: linked-in commands may dup2() over the real one */
+  bool own_tee_fd = (job->output_fd == -1);
+  capture.tee_fd = own_tee_fd ? fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0)
+                              : job->output_fd;
+  if (capture.tee_fd == -1) {
+    perror("dup stdout");
+    free(capture.data);
     return NULL;
   }
-  
-  size_t total_read = 0;
-  while (total_read < buffer_len) {
-    read_result = read(buffer_pipe[0], buffer + total_read, 
-                       buffer_len - total_read);
-    if (read_result <= 0) {
-      perror("read buffer content");
-      free(buffer);
-      close(buffer_pipe[0]);
-      job->output_fd = saved_output_fd;
-      if (saved_output_fd == -1) {
-        close(original_output_fd);
-      }
-      return NULL;
-    }
-    total_read += read_result;
+
+  int result = 0;
+  bool in_memory = jshell_job_can_write_stream(job);
+  bool ran = in_memory ? jshell_capture_in_memory(job, &capture, &result)
+                       : jshell_capture_through_pipe(job, &capture, &result);
+  if (own_tee_fd) {
+    close(capture.tee_fd);
+  }
+  if (!ran) {
+    free(capture.data);
+    return NULL;
   }
-  
-  close(buffer_pipe[0]);
-  
-  job->output_fd = saved_output_fd;
-  if (saved_output_fd == -1) {
-    close(original_output_fd);
+  capture.data[capture.len] = '\0';
+
+  if (capture.truncated) {
+    fprintf(stderr, "jshell: captured output truncated to %zu bytes\n",
+            capture.len);
   }
-  
+
   if (result != 0) {
     DPRINT("Command execution failed with status %d", result);
   }
-  
-  DPRINT("Captured output: %s", buffer);
-  return buffer;
+
+  DPRINT("Captured %zu bytes%s", capture.len, in_memory ? " in memory" : "");
+  jshell_stats_add(JSHELL_STAT_CAPTURES, 1);
+  jshell_stats_add(JSHELL_STAT_CAPTURE_BYTES, capture.len);
+  jshell_trace_end("capture", in_memory ? "memory" : "pipe", trace_start);
+  return capture.data;
 }
 
 
 /**
- * @brief Sets an environment variable with whitespace trimming.
+ * @brief Sets a shell variable with whitespace trimming.
  *
  * Trims leading and trailing whitespace from the value before setting
- * the environment variable.
+ * the variable. A new variable is shell-local; one that is already
+ * exported stays exported.
  *
  * @param name The variable name.
  * @param value The variable value (will be trimmed).
@@ -1045,11 +1551,11 @@ int jshell_set_env_var(const char* name, const char* value) {
   }
   *(end + 1) = '\0';
   
-  int result = setenv(name, start, 1);
+  int result = jshell_var_set(name, start, 0);
   if (result == -1) {
-    perror("setenv");
+    perror(name);
   } else {
-    DPRINT("Set environment variable: %s=%s", name, start);
+    DPRINT("Set shell variable: %s=%s", name, start);
   }
   
   free(trimmed_value);
@@ -1057,10 +1563,48 @@ int jshell_set_env_var(const char* name, const char* value) {
 }
 
 
+/**
+ * @brief Allocates an execution job with room for its command vector.
+ *
+ * The job, its JShellCmdVector and the JShellCmdParams array live in one
+ * zeroed block, so a single free() of the job releases all of them once
+ * jshell_cleanup_job has run.
+ *
+ * @param job_type Foreground or background job type.
+ * @param cmd_count Number of commands (pipeline stages).
+ * @return Allocated job with no redirections, or NULL on error.
+ */
+JShellExecJob* jshell_create_exec_job(ExecJobType job_type,
+                                      size_t cmd_count) {
+  char* block = calloc(1, sizeof(JShellExecJob) + sizeof(JShellCmdVector)
+                          + cmd_count * sizeof(JShellCmdParams));
+  if (block == NULL) {
+    return NULL;
+  }
+
+  JShellExecJob* job = (JShellExecJob*)block;
+  JShellCmdVector* cmd_vector =
+    (JShellCmdVector*)(block + sizeof(JShellExecJob));
+
+  cmd_vector->cmd_count = cmd_count;
+  cmd_vector->jshell_cmd_params_ptr =
+    (JShellCmdParams*)(block + sizeof(JShellExecJob)
+                       + sizeof(JShellCmdVector));
+
+  job->exec_job_type = job_type;
+  job->jshell_cmd_vector_ptr = cmd_vector;
+  job->input_fd = -1;
+  job->output_fd = -1;
+
+  return job;
+}
+
+
 /**
  * @brief Cleans up a command vector and frees associated resources.
  *
- * Releases word expansion results for all commands in the vector.
+ * Releases word expansion results for all commands in the vector. The
+ * vector itself belongs to the job block from jshell_create_exec_job.
  *
  * @param cmd_vector The command vector to clean up.
  */
@@ -1073,9 +1617,9 @@ void jshell_cleanup_cmd_vector(JShellCmdVector* cmd_vector) {
   
   if (cmd_vector->jshell_cmd_params_ptr != NULL) {
     for (size_t i = 0; i < cmd_vector->cmd_count; i++) {
-      wordfree(&cmd_vector->jshell_cmd_params_ptr[i].word_expansion);
+      jshell_words_free(
+        &cmd_vector->jshell_cmd_params_ptr[i].word_expansion);
     }
-    free(cmd_vector->jshell_cmd_params_ptr);
   }
 }
 
@@ -1083,7 +1627,8 @@ void jshell_cleanup_cmd_vector(JShellCmdVector* cmd_vector) {
 /**
  * @brief Cleans up an execution job and frees associated resources.
  *
- * Releases command vector, closes file descriptors for I/O redirection.
+ * Releases word expansions and closes file descriptors for I/O
+ * redirection. The caller still frees the job itself.
  *
  * @param job The execution job to clean up.
  */
@@ -1096,7 +1641,6 @@ void jshell_cleanup_job(JShellExecJob* job) {
   
   if (job->jshell_cmd_vector_ptr != NULL) {
     jshell_cleanup_cmd_vector(job->jshell_cmd_vector_ptr);
-    free(job->jshell_cmd_vector_ptr);
   }
   
   if (job->input_fd != -1) {
@@ -1106,4 +1650,8 @@ void jshell_cleanup_job(JShellExecJob* job) {
   if (job->output_fd != -1) {
     close(job->output_fd);
   }
+
+  free(job->stage_usage);
+  job->stage_usage = NULL;
+  jshell_sched_free(&job->sched);
 }
@@ -1,17 +1,20 @@
 #ifndef JSHELL_AST_HELPERS_H
 #define JSHELL_AST_HELPERS_H
 
-#include <wordexp.h>
-
 #include "jshell_ast_interpreter.h"
 
-#define MAX_VAR_SIZE 8192
-
+// Largest command substitution kept by jshell_capture_and_tee_output
+#define MAX_CAPTURE_SIZE (64 * 1024 * 1024)
+// Initial capture buffer size, doubled as output arrives
+#define CAPTURE_INITIAL_SIZE 8192
+// Bytes requested from the capture pipe per read
+#define CAPTURE_READ_SIZE 4096
 
-int jshell_expand_word(char* word, wordexp_t* word_vector_ptr);
 
 int jshell_exec_job(JShellExecJob* job);
 
+JShellExecJob* jshell_create_exec_job(ExecJobType job_type, size_t cmd_count);
+
 void jshell_cleanup_job(JShellExecJob* job);
 
 void jshell_cleanup_cmd_vector(JShellCmdVector* cmd_vector);
@@ -9,10 +9,10 @@
 
 /* File generated by the BNF Converter (bnfc 2.9.6.1). */
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <wordexp.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
@@ -20,28 +20,23 @@
 #include "utils/jbox_utils.h"
 #include "jshell/jshell.h"
 #include "jshell/jshell_ai.h"
+#include "jshell/jshell_job_control.h"
+#include "jshell/jshell_trace.h"
 #include "Parser.h"
 #include "Absyn.h"
 
 #include "jshell_ast_interpreter.h"
 #include "jshell_ast_helpers.h"
+#include "jshell_ast_opt.h"
+#include "jshell_ast_parser.h"
 
 /* Forward declarations of private functions */
-void visitListJob(ListJob p);
-void visitJob(Job p);
-JShellExecJob* visitCommandLine(CommandLine p, ExecJobType job_type);
-JShellCmdVector* visitCommandPart(CommandPart p);
-JShellCmdParams visitCommandUnit(CommandUnit p);
-int visitOptionalInputRedirection(OptionalInputRedirection p);
-int visitOptionalOutputRedirection(OptionalOutputRedirection p);
-int visitListShellToken(ListShellToken p, wordexp_t* word_vector_ptr);
-int visitShellToken(ShellToken p, wordexp_t* word_vector_ptr);
-int visitExpansionStringToken(ExpansionStringToken p, 
-                              wordexp_t* word_vector_ptr);
-int visitLiteralStringToken(LiteralStringToken p, 
-                            wordexp_t* word_vector_ptr);
-int visitVariableToken(VariableToken p, wordexp_t* word_vector_ptr);
-int visitWordToken(WordToken p, wordexp_t* word_vector_ptr);
+int visitExpansionStringToken(ExpansionStringToken p,
+                              JShellWords* word_vector_ptr);
+int visitLiteralStringToken(LiteralStringToken p,
+                            JShellWords* word_vector_ptr);
+int visitVariableToken(VariableToken p, JShellWords* word_vector_ptr);
+int visitWordToken(WordToken p, JShellWords* word_vector_ptr);
 void visitAIQueryToken(AIQueryToken p);
 void visitAIExecToken(AIExecToken p);
 void visitIdent(Ident i);
@@ -53,511 +48,397 @@ void visitString(String s);
 
 /**
  * @brief Interprets and executes a parsed input AST node.
+ *
+ * Lowers the tree to an execution plan and runs it. Callers that run the
+ * same line repeatedly should keep the plan instead (see the parse cache).
+ *
  * @param p The input AST node to interpret.
- * @return 0 on success.
+ * @return 0 on success, -1 if the plan could not be built.
  */
 int interpretInput(Input p)
 {
   DPRINT("visiting_Input");
-  switch(p->kind)
-  {
-  case is_In:
-    visitListJob(p->u.in_.listjob_);
-    return 0;
 
-  default:
-    fprintf(stderr, "Error: bad kind field when printing Input!\n");
-    exit(1);
+  JShellPlan* plan = jshell_plan_build(p);
+  if (plan == NULL) {
+    return -1;
   }
-}
-
 
-/**
- * @brief Visits and executes a list of job AST nodes.
- * @param listjob The list of jobs to visit.
- */
-void visitListJob(ListJob listjob)
-{
-  DPRINT("visiting ListJob");
-  while(listjob != 0)
-  {
-    visitJob(listjob->job_);
-    listjob = listjob->listjob_;
-  }
+  jshell_exec_plan(plan);
+  jshell_plan_free(plan);
+  return 0;
 }
 
 
 /**
- * @brief Visits and executes a job AST node.
+ * @brief Expands one plan word, appending to a word vector.
  *
- * Handles different job types including assignments, foreground jobs,
- * background jobs, AI chat queries, and AI execution queries.
+ * Dispatches on the token kind recorded when the plan was lowered.
  *
- * @param p The job AST node to visit.
+ * @param word The plan word.
+ * @param word_vector_ptr Word list accumulating the results.
+ * @return 0 on success, WRDE_* error code on failure.
  */
-void visitJob(Job p)
+static int expand_plan_word(const JShellPlanWord* word,
+                            JShellWords* word_vector_ptr)
 {
-  DPRINT("visiting Job");
-  
-  switch(p->kind)
+  switch(word->kind)
   {
-  case is_AssigJob:
-    DPRINT("is AssigJob");
-    {
-      wordexp_t var_name_expansion = {0};
-      int result = 
-        visitShellToken(p->u.assigJob_.shelltoken_, &var_name_expansion);
-      
-      if (result != 0 || var_name_expansion.we_wordc != 1) {
-        fprintf(stderr, "Error: invalid variable name in assignment\n");
-        wordfree(&var_name_expansion);
-        break;
-      }
-      
-      char* var_name = var_name_expansion.we_wordv[0];
-      DPRINT("Assignment variable name: %s", var_name);
-      
-      JShellExecJob* exec_job = 
-        visitCommandLine(p->u.assigJob_.commandline_, FG_JOB);
-      
-      if (exec_job != NULL) {
-        char* captured_output = jshell_capture_and_tee_output(exec_job);
-        
-        if (captured_output != NULL) {
-          jshell_set_env_var(var_name, captured_output);
-          free(captured_output);
-        } else {
-          fprintf(stderr, "Error: failed to capture command output\n");
-        }
-        
-        jshell_cleanup_job(exec_job);
-        free(exec_job);
-      }
-      
-      wordfree(&var_name_expansion);
-    }
-    break;
-    
-  case is_FGJob:
-    DPRINT("is FGJob");
-    {
-      JShellExecJob* exec_job = 
-        visitCommandLine(p->u.fGJob_.commandline_, FG_JOB);
-      if (exec_job != NULL) {
-        jshell_exec_job(exec_job);
-        jshell_cleanup_job(exec_job);
-        free(exec_job);
-      }
-    }
-    break;
-    
-  case is_BGJob:
-    DPRINT("is BGJob");
-    {
-      JShellExecJob* exec_job = 
-        visitCommandLine(p->u.bGJob_.commandline_, BG_JOB);
-      if (exec_job != NULL) {
-        jshell_exec_job(exec_job);
-        jshell_cleanup_job(exec_job);
-        free(exec_job);
-      }
-    }
-    break;
-    
-  case is_AIChatJob:
-    DPRINT("is AIChatJob");
-    visitAIQueryToken(p->u.aIChatJob_.aiquerytoken_);
-    break;
-    
-  case is_AIExecJob:
-    DPRINT("is AIExecJob");
-    visitAIExecToken(p->u.aIExecJob_.aiexectoken_);
-    break;
+  case PLAN_WORD_EXPANSION_STRING:
+    return visitExpansionStringToken(word->text, word_vector_ptr);
+  case PLAN_WORD_LITERAL_STRING:
+    return visitLiteralStringToken(word->text, word_vector_ptr);
+  case PLAN_WORD_VARIABLE:
+    return visitVariableToken(word->text, word_vector_ptr);
+  case PLAN_WORD_WORD:
+    return visitWordToken(word->text, word_vector_ptr);
 
   default:
-    fprintf(stderr, "Error: bad kind field when printing Job!\n");
+    fprintf(stderr, "Error: bad kind field in plan word!\n");
     exit(1);
   }
 }
 
 
 /**
- * @brief Visits a command line AST node and builds an executable job.
+ * @brief Expands the words of a pipeline stage into argc/argv.
  *
- * Processes input/output redirection and command parts to create a
- * JShellExecJob structure ready for execution.
+ * Also resolves the command spec for argv[0] so that execution does not
+ * have to look the command up again.
  *
- * @param p The command line AST node.
- * @param job_type The type of job (foreground or background).
- * @return Pointer to allocated JShellExecJob, or NULL on error.
+ * @param stage The plan stage.
+ * @param cmd_params Zeroed command parameters to fill in.
+ * @return 0 on success, -1 if expansion failed.
  */
-JShellExecJob* visitCommandLine(CommandLine p, ExecJobType job_type)
+static int expand_plan_stage(const JShellPlanStage* stage,
+                             JShellCmdParams* cmd_params)
 {
-  DPRINT("visiting CommandLine");
-
-  switch(p->kind)
-  {
-  case is_CmdLine:
-    {
-      int input_fd =
-        visitOptionalInputRedirection(
-          p->u.cmdLine_.optionalinputredirection_);
-
-      // Check for redirection error (-2 means error, -1 means no redirection)
-      if (input_fd == -2) {
-        jshell_set_last_exit_status(1);
-        return NULL;
-      }
-
-      JShellCmdVector* cmd_vector =
-        visitCommandPart(p->u.cmdLine_.commandpart_);
-
-      int output_fd =
-        visitOptionalOutputRedirection(
-          p->u.cmdLine_.optionaloutputredirection_);
-
-      // Check for output redirection error
-      if (output_fd == -2) {
-        if (input_fd != -1) close(input_fd);
-        if (cmd_vector != NULL) {
-          jshell_cleanup_cmd_vector(cmd_vector);
-          free(cmd_vector);
-        }
-        jshell_set_last_exit_status(1);
-        return NULL;
-      }
-
-      if (cmd_vector == NULL) {
-        if (input_fd != -1) close(input_fd);
-        if (output_fd != -1) close(output_fd);
-        return NULL;
-      }
-
-      JShellExecJob* exec_job = malloc(sizeof(JShellExecJob));
-      if (exec_job == NULL) {
-        perror("malloc JShellExecJob");
-        if (input_fd != -1) close(input_fd);
-        if (output_fd != -1) close(output_fd);
-        jshell_cleanup_cmd_vector(cmd_vector);
-        free(cmd_vector);
-        return NULL;
-      }
+  int result = 0;
+  for (size_t i = 0; i < stage->word_count && result == 0; i++) {
+    result = expand_plan_word(&stage->words[i], &cmd_params->word_expansion);
+  }
 
-      exec_job->exec_job_type = job_type;
-      exec_job->jshell_cmd_vector_ptr = cmd_vector;
-      exec_job->input_fd = input_fd;
-      exec_job->output_fd = output_fd;
+  DPRINT("expansion result: %d", result);
 
-      DPRINT("Built JShellExecJob: type=%d, cmd_count=%zu, input_fd=%d, "
-             "output_fd=%d",
-             job_type, cmd_vector->cmd_count, input_fd, output_fd);
+  if (result != 0) {
+    fprintf(stderr, "Error: word expansion failed with code %d\n", result);
+    cmd_params->argc = 0;
+    cmd_params->argv = NULL;
+    return -1;
+  }
 
-      return exec_job;
-    }
-    break;
+  cmd_params->argc = (int)cmd_params->word_expansion.wordc;
+  cmd_params->argv = cmd_params->word_expansion.wordv;
+  if (cmd_params->argc > 0) {
+    cmd_params->spec = jshell_find_command(cmd_params->argv[0]);
+  }
 
-  default:
-    fprintf(stderr, "Error: bad kind field when printing CommandLine!\n");
-    exit(1);
+  DPRINT("Built JShellCmdParams: argc=%d", cmd_params->argc);
+  for (int i = 0; i < cmd_params->argc; i++) {
+    DPRINT("  argv[%d]=%s", i, cmd_params->argv[i]);
   }
+  return 0;
 }
 
 
 /**
- * @brief Visits a command part AST node and builds a command vector.
+ * @brief Recognizes a leading `time` and strips it from the first stage.
  *
- * Processes piped commands and constructs a vector of command parameters
- * for pipeline execution.
+ * `time [--json] command ...` times the whole job, pipeline included, as
+ * the shell keyword does; the prefix is taken off before the job runs.
+ * Anything else starting with `time` (no command, or an option such as
+ * --help) runs the time builtin instead. Background jobs are not timed;
+ * `jobs --json` reports their usage.
  *
- * @param p The command part AST node.
- * @return Pointer to allocated JShellCmdVector, or NULL on error.
+ * @param job The job being built.
+ * @param cmd_params The expanded first stage.
  */
-JShellCmdVector* visitCommandPart(CommandPart p)
+static void strip_time_prefix(JShellExecJob* job,
+                              JShellCmdParams* cmd_params)
 {
-  DPRINT("visiting CommandPart");
-  
-  size_t cmd_count = 0;
-  CommandPart temp = p;
-  
-  while (temp != NULL) {
-    cmd_count++;
-    if (temp->kind == is_SnglCmd) {
-      break;
-    } else if (temp->kind == is_PipeCmd) {
-      temp = temp->u.pipeCmd_.commandpart_;
-    } else {
-      fprintf(stderr, "Error: unexpected CommandPart kind!\n");
-      return NULL;
-    }
+  if (cmd_params->argc < 2 || strcmp(cmd_params->argv[0], "time") != 0) {
+    return;
   }
-  
-  DPRINT("cmd_count = %zu", cmd_count);
-  
-  JShellCmdVector* cmd_vector = malloc(sizeof(JShellCmdVector));
-  if (cmd_vector == NULL) {
-    perror("malloc JShellCmdVector");
-    return NULL;
+
+  int skip = 1;
+  ExecTimeMode mode = TIME_TEXT;
+  if (strcmp(cmd_params->argv[1], "--json") == 0) {
+    skip = 2;
+    mode = TIME_JSON;
+  } else if (cmd_params->argv[1][0] == '-') {
+    return;
   }
-  
-  cmd_vector->cmd_count = cmd_count;
-  cmd_vector->jshell_cmd_params_ptr = 
-    malloc(sizeof(JShellCmdParams) * cmd_count);
-  if (cmd_vector->jshell_cmd_params_ptr == NULL) {
-    perror("malloc JShellCmdParams array");
-    free(cmd_vector);
-    return NULL;
+  if (cmd_params->argc <= skip) {
+    return;
   }
-  
-  size_t index = 0;
-  temp = p;
-  
-  while (temp != NULL && index < cmd_count) {
-    if (temp->kind == is_SnglCmd) {
-      DPRINT("is SnglCmd at index %zu", index);
-      cmd_vector->jshell_cmd_params_ptr[index] = 
-        visitCommandUnit(temp->u.snglCmd_.commandunit_);
-      break;
-    } else if (temp->kind == is_PipeCmd) {
-      DPRINT("is PipeCmd at index %zu", index);
-      cmd_vector->jshell_cmd_params_ptr[index] = 
-        visitCommandUnit(temp->u.pipeCmd_.commandunit_);
-      index++;
-      temp = temp->u.pipeCmd_.commandpart_;
-    }
+
+  /* word_expansion still owns the skipped words */
+  cmd_params->argc -= skip;
+  cmd_params->argv += skip;
+  cmd_params->spec = jshell_find_command(cmd_params->argv[0]);
+
+  if (job->exec_job_type == BG_JOB) {
+    return;
   }
-  
-  return cmd_vector;
+  job->stage_usage = calloc(job->jshell_cmd_vector_ptr->cmd_count,
+                            sizeof(JShellUsage));
+  if (job->stage_usage == NULL) {
+    perror("time");
+    return;
+  }
+  job->time_mode = mode;
 }
 
 
 /**
- * @brief Processes optional input redirection from AST node.
+ * @brief Recognizes a leading `run` and strips it from the first stage.
  *
- * Opens the specified input file for redirection if present.
+ * `run [--cpus LIST] [--nice N] [--cgroup PATH] command ...` places the
+ * processes of the whole job; the prefix is taken off before the job
+ * runs and may follow `time`. Anything else starting with `run` (no
+ * command, --help) runs the run builtin instead.
  *
- * @param p The optional input redirection AST node.
- * @return File descriptor for input redirection, -1 if none, -2 on error.
+ * @param job The job being built.
+ * @param cmd_params The expanded first stage.
+ * @return 0, or -1 if an option of the prefix is malformed.
  */
-int visitOptionalInputRedirection(OptionalInputRedirection p)
+static int strip_run_prefix(JShellExecJob* job,
+                            JShellCmdParams* cmd_params)
 {
-  DPRINT("visiting OptionalInputRedirection");
-
-  wordexp_t word_vector = {0};
-
-  switch(p->kind)
-  {
-  case is_NoInRedir:
-    DPRINT("is NoInRedir");
+  const char* error = NULL;
+  int skip = jshell_sched_parse_prefix(&job->sched, cmd_params->argc,
+                                       cmd_params->argv, &error);
+  if (skip < 0) {
+    fprintf(stderr, "run: %s\n", error);
     return -1;
-    
-  case is_InRedir:
-    DPRINT("is InRedir");
-    {
-      int result =
-        visitShellToken(p->u.inRedir_.shelltoken_, &word_vector);
-      DPRINT("wordexp result: %d", result);
-
-      if (result != 0 || word_vector.we_wordc != 1) {
-        fprintf(stderr, "jshell: invalid input redirection\n");
-        wordfree(&word_vector);
-        return -2;  // -2 indicates error (vs -1 for no redirection)
-      }
-
-      DPRINT("Opening input file: %s", word_vector.we_wordv[0]);
-      int fd = open(word_vector.we_wordv[0], O_RDONLY);
-      if (fd == -1) {
-        fprintf(stderr, "jshell: %s: %s\n", word_vector.we_wordv[0],
-                strerror(errno));
-        wordfree(&word_vector);
-        return -2;  // -2 indicates error
-      }
-      DPRINT("Opened input file: fd=%d", fd);
-
-      wordfree(&word_vector);
-      return fd;
-    }
-
-  default:
-    fprintf(stderr, 
-            "Error: bad kind field when printing "
-            "OptionalInputRedirection!\n");
-    exit(1);
   }
+  if (skip == 0) {
+    return 0;
+  }
+
+  /* word_expansion still owns the skipped words */
+  cmd_params->argc -= skip;
+  cmd_params->argv += skip;
+  cmd_params->spec = jshell_find_command(cmd_params->argv[0]);
+  return 0;
 }
 
 
 /**
- * @brief Processes optional output redirection from AST node.
- *
- * Opens the specified output file for redirection if present. Creates the
- * file if it doesn't exist, truncates if it does.
+ * @brief Opens the file named by a redirection word.
  *
- * @param p The optional output redirection AST node.
- * @return File descriptor for output redirection, -1 if none, -2 on error.
+ * @param word The redirection target word.
+ * @param flags open() flags.
+ * @param what "input" or "output", for error messages.
+ * @return File descriptor, or -2 on error.
  */
-int visitOptionalOutputRedirection(OptionalOutputRedirection p)
+static int open_redirection(const JShellPlanWord* word, int flags,
+                            const char* what)
 {
-  DPRINT("visiting OptionalOutputRedirection");
+  JShellWords word_vector = {0};
 
-  wordexp_t word_vector = {0};
+  int result = expand_plan_word(word, &word_vector);
+  DPRINT("expansion result: %d", result);
 
-  switch(p->kind)
-  {
-  case is_NoOutRedir:
-    DPRINT("is NoOutRedir");
-    return -1;
-    
-  case is_OutRedir:
-    DPRINT("is OutRedir");
-    {
-      int result =
-        visitShellToken(p->u.outRedir_.shelltoken_, &word_vector);
-      DPRINT("wordexp result: %d", result);
-
-      if (result != 0 || word_vector.we_wordc != 1) {
-        fprintf(stderr, "jshell: invalid output redirection\n");
-        wordfree(&word_vector);
-        return -2;  // -2 indicates error (vs -1 for no redirection)
-      }
-
-      DPRINT("Opening output file: %s", word_vector.we_wordv[0]);
-      int fd = open(word_vector.we_wordv[0],
-                    O_WRONLY | O_CREAT | O_TRUNC,
-                    0644);
-      if (fd == -1) {
-        fprintf(stderr, "jshell: %s: %s\n", word_vector.we_wordv[0],
-                strerror(errno));
-        wordfree(&word_vector);
-        return -2;  // -2 indicates error
-      }
-      DPRINT("Opened output file: fd=%d", fd);
-
-      wordfree(&word_vector);
-      return fd;
-    }
+  if (result != 0 || word_vector.wordc != 1) {
+    fprintf(stderr, "jshell: invalid %s redirection\n", what);
+    jshell_words_free(&word_vector);
+    return -2;  // -2 indicates error (vs -1 for no redirection)
+  }
 
-  default:
-    fprintf(stderr, 
-            "Error: bad kind field when printing "
-            "OptionalOutputRedirection!\n");
-    exit(1);
+  DPRINT("Opening %s file: %s", what, word_vector.wordv[0]);
+  int fd = open(word_vector.wordv[0], flags | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    fprintf(stderr, "jshell: %s: %s\n", word_vector.wordv[0],
+            strerror(errno));
+    jshell_words_free(&word_vector);
+    return -2;
   }
+  DPRINT("Opened %s file: fd=%d", what, fd);
+
+  jshell_words_free(&word_vector);
+  return fd;
 }
 
 
 /**
- * @brief Visits a command unit AST node and extracts command parameters.
+ * @brief Builds an executable job from a plan job.
  *
- * Performs word expansion on the command tokens and constructs argc/argv
- * style command parameters.
+ * Opens the redirections and expands every stage into a job created with
+ * a single allocation, then lets the optimizer simplify the pipeline.
  *
- * @param p The command unit AST node.
- * @return JShellCmdParams structure containing command arguments.
+ * @param plan_job The plan job (foreground, background or assignment).
+ * @param job_type The type of job (foreground or background).
+ * @return Pointer to allocated JShellExecJob, or NULL on error.
  */
-JShellCmdParams visitCommandUnit(CommandUnit p)
+static JShellExecJob* build_exec_job(const JShellPlanJob* plan_job,
+                                     ExecJobType job_type)
 {
-  DPRINT("visiting CommandUnit");
-
-  JShellCmdParams cmd_params;
-  memset(&cmd_params, 0, sizeof(JShellCmdParams));
+  int input_fd = -1;
+  if (plan_job->input_redir != NULL) {
+    input_fd = open_redirection(plan_job->input_redir, O_RDONLY, "input");
+    if (input_fd == -2) {
+      jshell_set_last_exit_status(1);
+      return NULL;
+    }
+  }
 
-  switch(p->kind)
-  {
-  case is_CmdUnit:
-    {
-      int result = 
-        visitListShellToken(p->u.cmdUnit_.listshelltoken_, 
-                           &cmd_params.word_expansion);
-
-      DPRINT("wordexp result: %d", result);
-
-      if (result == 0) {
-        cmd_params.argc = (int)cmd_params.word_expansion.we_wordc;
-        cmd_params.argv = cmd_params.word_expansion.we_wordv;
-        
-        DPRINT("Built JShellCmdParams: argc=%d", cmd_params.argc);
-        for (int i = 0; i < cmd_params.argc; i++) {
-          DPRINT("  argv[%d]=%s", i, cmd_params.argv[i]);
-        }
-      } else {
-        fprintf(stderr, "Error: word expansion failed with code %d\n", 
-                result);
-        cmd_params.argc = 0;
-        cmd_params.argv = NULL;
+  JShellExecJob* exec_job =
+    jshell_create_exec_job(job_type, plan_job->stage_count);
+  if (exec_job == NULL) {
+    perror("malloc JShellExecJob");
+    if (input_fd != -1) close(input_fd);
+    return NULL;
+  }
+  exec_job->input_fd = input_fd;
+
+  for (size_t i = 0; i < plan_job->stage_count; i++) {
+    JShellCmdParams* cmd_params =
+      &exec_job->jshell_cmd_vector_ptr->jshell_cmd_params_ptr[i];
+    uint64_t trace_start = jshell_trace_begin();
+    int failed = expand_plan_stage(&plan_job->stages[i], cmd_params);
+    jshell_trace_end("expand", cmd_params->argc > 0 ? cmd_params->argv[0]
+                                                    : NULL, trace_start);
+    if (failed || cmd_params->argc == 0) {
+      /* A lone command that expands to nothing is a no-op */
+      int status = 0;
+      if (failed) {
+        status = 1;
+      } else if (plan_job->stage_count > 1) {
+        fprintf(stderr, "jshell: empty command in pipeline\n");
+        status = 1;
+      }
+      jshell_cleanup_job(exec_job);
+      free(exec_job);
+      jshell_set_last_exit_status(status);
+      return NULL;
+    }
+    if (i == 0) {
+      strip_time_prefix(exec_job, cmd_params);
+      if (strip_run_prefix(exec_job, cmd_params) != 0) {
+        jshell_cleanup_job(exec_job);
+        free(exec_job);
+        jshell_set_last_exit_status(1);
+        return NULL;
       }
-      
-      return cmd_params;
     }
+  }
 
-  default:
-    fprintf(stderr, "Error: bad kind field when printing CommandUnit!\n");
-    exit(1);
+  if (plan_job->output_redir != NULL) {
+    int output_fd = open_redirection(plan_job->output_redir,
+                                     O_WRONLY | O_CREAT | O_TRUNC,
+                                     "output");
+    if (output_fd == -2) {
+      jshell_cleanup_job(exec_job);
+      free(exec_job);
+      jshell_set_last_exit_status(1);
+      return NULL;
+    }
+    exec_job->output_fd = output_fd;
   }
+
+  jshell_optimize_job(exec_job);
+
+  DPRINT("Built JShellExecJob: type=%d, cmd_count=%zu, input_fd=%d, "
+         "output_fd=%d",
+         job_type, exec_job->jshell_cmd_vector_ptr->cmd_count,
+         exec_job->input_fd, exec_job->output_fd);
+
+  return exec_job;
 }
 
 
 /**
- * @brief Visits a list of shell tokens and performs word expansion.
- *
- * Iterates through shell tokens and accumulates expanded words into
- * the provided word vector.
- *
- * @param listshelltoken The list of shell tokens to visit.
- * @param word_vector_ptr Pointer to wordexp_t for accumulating results.
- * @return 0 on success, wordexp error code on failure.
+ * @brief Runs an assignment job: captures the command output into a var.
+ * @param plan_job The assignment plan job.
  */
-int visitListShellToken(ListShellToken listshelltoken,
-                        wordexp_t* word_vector_ptr)
+static void exec_assign_job(const JShellPlanJob* plan_job)
 {
-  DPRINT("visiting ListShellToken");
+  JShellWords var_name_expansion = {0};
+  int result = expand_plan_word(plan_job->assign_name, &var_name_expansion);
 
-  int wordexp_result = 0;
+  if (result != 0 || var_name_expansion.wordc != 1) {
+    fprintf(stderr, "Error: invalid variable name in assignment\n");
+    jshell_words_free(&var_name_expansion);
+    return;
+  }
 
-  while(listshelltoken != 0)
-  {
-    wordexp_result = 
-      visitShellToken(listshelltoken->shelltoken_, word_vector_ptr);
-    if (wordexp_result != 0) {
-      return wordexp_result;
+  char* var_name = var_name_expansion.wordv[0];
+  DPRINT("Assignment variable name: %s", var_name);
+
+  JShellExecJob* exec_job = build_exec_job(plan_job, FG_JOB);
+
+  if (exec_job != NULL) {
+    char* captured_output = jshell_capture_and_tee_output(exec_job);
+
+    if (captured_output != NULL) {
+      jshell_set_env_var(var_name, captured_output);
+      free(captured_output);
+    } else {
+      fprintf(stderr, "Error: failed to capture command output\n");
     }
 
-    listshelltoken = listshelltoken->listshelltoken_;
+    jshell_cleanup_job(exec_job);
+    free(exec_job);
   }
-  return wordexp_result;
+
+  jshell_words_free(&var_name_expansion);
 }
 
 
 /**
- * @brief Visits a shell token AST node and dispatches to appropriate handler.
+ * @brief Executes every job of a plan in order.
  *
- * Routes the shell token to the appropriate visitor based on its type
- * (expansion string, literal string, variable, or word).
+ * Handles assignments, foreground jobs, background jobs, AI chat queries,
+ * and AI execution queries. The plan is not modified, so it can be run
+ * again later.
  *
- * @param p The shell token AST node.
- * @param word_vector_ptr Pointer to wordexp_t for accumulating results.
- * @return 0 on success, wordexp error code on failure.
+ * @param plan The execution plan.
+ * @return 0 on success.
  */
-int visitShellToken(ShellToken p, wordexp_t* word_vector_ptr)
+int jshell_exec_plan(const JShellPlan* plan)
 {
-  DPRINT("visiting ShellToken");
+  for (size_t i = 0; i < plan->job_count; i++) {
+    const JShellPlanJob* plan_job = &plan->jobs[i];
 
-  switch(p->kind)
-  {
-  case is_ExpStr:
-    return visitExpansionStringToken(p->u.expStr_.expansionstringtoken_, 
-                                     word_vector_ptr);
-  case is_LitStr:
-    return visitLiteralStringToken(p->u.litStr_.literalstringtoken_, 
-                                   word_vector_ptr);
-  case is_Var:
-    return visitVariableToken(p->u.var_.variabletoken_, word_vector_ptr);
-  case is_Wrd:
-    return visitWordToken(p->u.wrd_.wordtoken_, word_vector_ptr);
+    switch(plan_job->kind)
+    {
+    case PLAN_ASSIGN_JOB:
+      DPRINT("is AssigJob");
+      exec_assign_job(plan_job);
+      break;
 
-  default:
-    fprintf(stderr, "Error: bad kind field when printing ShellToken!\n");
-    exit(1);
+    case PLAN_FG_JOB:
+    case PLAN_BG_JOB:
+      DPRINT("is %s", plan_job->kind == PLAN_FG_JOB ? "FGJob" : "BGJob");
+      {
+        JShellExecJob* exec_job = build_exec_job(
+          plan_job, plan_job->kind == PLAN_FG_JOB ? FG_JOB : BG_JOB);
+        if (exec_job != NULL) {
+          jshell_exec_job(exec_job);
+          jshell_cleanup_job(exec_job);
+          free(exec_job);
+        }
+      }
+      break;
+
+    case PLAN_AI_CHAT_JOB:
+      DPRINT("is AIChatJob");
+      visitAIQueryToken(plan_job->ai_text);
+      break;
+
+    case PLAN_AI_EXEC_JOB:
+      DPRINT("is AIExecJob");
+      visitAIExecToken(plan_job->ai_text);
+      break;
+
+    default:
+      fprintf(stderr, "Error: bad kind field in plan job!\n");
+      exit(1);
+    }
   }
+
+  return 0;
 }
 
 
@@ -620,11 +501,11 @@ static char* preprocess_special_vars(const char* str) {
  * with shell variable and glob expansion enabled.
  *
  * @param p The expansion string token.
- * @param word_vector_ptr Pointer to wordexp_t for accumulating results.
- * @return 0 on success, wordexp error code on failure.
+ * @param word_vector_ptr Word list accumulating the results.
+ * @return 0 on success, WRDE_* error code on failure.
  */
 int visitExpansionStringToken(ExpansionStringToken p,
-                              wordexp_t* word_vector_ptr)
+                              JShellWords* word_vector_ptr)
 {
   DPRINT("visiting ExpansionStringToken: %s", p);
 
@@ -646,11 +527,11 @@ int visitExpansionStringToken(ExpansionStringToken p,
  * Treats the token as a literal string with minimal expansion.
  *
  * @param p The literal string token.
- * @param word_vector_ptr Pointer to wordexp_t for accumulating results.
- * @return 0 on success, wordexp error code on failure.
+ * @param word_vector_ptr Word list accumulating the results.
+ * @return 0 on success, WRDE_* error code on failure.
  */
 int visitLiteralStringToken(LiteralStringToken p,
-                            wordexp_t* word_vector_ptr)
+                            JShellWords* word_vector_ptr)
 {
   DPRINT("visiting LiteralStringToken: %s", p);
   return jshell_expand_word(p, word_vector_ptr);
@@ -664,10 +545,10 @@ int visitLiteralStringToken(LiteralStringToken p,
  * other variables from the environment.
  *
  * @param p The variable token.
- * @param word_vector_ptr Pointer to wordexp_t for accumulating results.
- * @return 0 on success, wordexp error code on failure.
+ * @param word_vector_ptr Word list accumulating the results.
+ * @return 0 on success, WRDE_* error code on failure.
  */
-int visitVariableToken(VariableToken p, wordexp_t* word_vector_ptr)
+int visitVariableToken(VariableToken p, JShellWords* word_vector_ptr)
 {
   DPRINT("visiting VariableToken: %s", p);
 
@@ -689,21 +570,63 @@ int visitVariableToken(VariableToken p, wordexp_t* word_vector_ptr)
  * Expands the word token using standard shell word expansion rules.
  *
  * @param p The word token.
- * @param word_vector_ptr Pointer to wordexp_t for accumulating results.
- * @return 0 on success, wordexp error code on failure.
+ * @param word_vector_ptr Word list accumulating the results.
+ * @return 0 on success, WRDE_* error code on failure.
  */
-int visitWordToken(WordToken p, wordexp_t* word_vector_ptr)
+int visitWordToken(WordToken p, JShellWords* word_vector_ptr)
 {
   DPRINT("visiting WordToken: %s", p);
   return jshell_expand_word(p, word_vector_ptr);
 }
 
 
+/**
+ * @brief Receives the answer to a background AI query.
+ *
+ * Runs on the AI background thread and hands the answer to the job table,
+ * which prints it when the job is reported done.
+ *
+ * @param answer The answer, or an error message.
+ * @param status 0 on success, 1 on error.
+ * @param ctx The job ID.
+ */
+static void ai_query_job_done(char *answer, int status, void *ctx)
+{
+  jshell_finish_thread_job((int)(intptr_t)ctx, status, answer);
+}
+
+
+/**
+ * @brief Starts an AI chat query as a background job.
+ *
+ * @param query The query text.
+ * @param cmd_string The job's command string for `jobs`.
+ */
+static void run_ai_query_job(const char *query, const char *cmd_string)
+{
+  int job_id = jshell_add_thread_job(cmd_string);
+  BackgroundJob *job = job_id > 0 ? jshell_find_job_by_id(job_id) : NULL;
+  if (job == NULL) {
+    jshell_set_last_exit_status(1);
+    return;
+  }
+
+  if (jshell_ai_chat_async(query, &job->cancelled, ai_query_job_done,
+                           (void *)(intptr_t)job_id) != 0) {
+    jshell_finish_thread_job(job_id, 1,
+                             strdup("AI error: could not start the query"));
+  }
+  jshell_set_last_exit_status(0);
+}
+
+
 /**
  * @brief Visits an AI query token and processes chat interaction.
  *
  * Extracts the query text, checks for AI availability, and sends the query
- * to the AI chat system. Prints the response to stdout.
+ * to the AI chat system. Prints the response to stdout as it streams in,
+ * or, when the query ends in " &", runs it as a background job whose
+ * answer is printed once it is ready.
  *
  * @param p The AI query token starting with '@'.
  */
@@ -711,6 +634,35 @@ void visitAIQueryToken(AIQueryToken p)
 {
   DPRINT("visiting AIQueryToken: %s", p);
 
+  if (!jshell_ai_available()) {
+    fprintf(stderr, "AI features require an API key.\n");
+    fprintf(stderr, "  Add GOOGLE_API_KEY=<your_key> to ~/.jshell/env\n");
+    jshell_set_last_exit_status(1);
+    return;
+  }
+
+  /* The token runs to the end of the job, so a trailing "&" is in it */
+  size_t len = strlen(p);
+  while (len > 1 && (p[len - 1] == ' ' || p[len - 1] == '\t')) {
+    len--;
+  }
+  if (len > 2 && p[len - 1] == '&'
+      && (p[len - 2] == ' ' || p[len - 2] == '\t')) {
+    size_t end = len - 1;
+    while (end > 1 && (p[end - 1] == ' ' || p[end - 1] == '\t')) {
+      end--;
+    }
+    char *cmd_string = strndup(p, end);
+    if (cmd_string == NULL) {
+      perror("jshell");
+      jshell_set_last_exit_status(1);
+      return;
+    }
+    run_ai_query_job(cmd_string + 1, cmd_string);
+    free(cmd_string);
+    return;
+  }
+
   /* Extract query (skip the '@' prefix) */
   const char *query = p + 1;
 
@@ -719,17 +671,8 @@ void visitAIQueryToken(AIQueryToken p)
     query = "Hi!";
   }
 
-  if (!jshell_ai_available()) {
-    fprintf(stderr, "AI features require an API key.\n");
-    fprintf(stderr, "  Add GOOGLE_API_KEY=<your_key> to ~/.jshell/env\n");
+  if (jshell_ai_chat_stream(query, stdout) != 0) {
     jshell_set_last_exit_status(1);
-    return;
-  }
-
-  char *response = jshell_ai_chat(query);
-  if (response != NULL) {
-    printf("%s\n", response);
-    free(response);
   }
 }
 
@@ -786,15 +729,17 @@ void visitAIExecToken(AIExecToken p)
   }
 
   /* Parse and execute the command */
-  Input parse_tree = psInput(command);
+  JShellParser parser = {0};
+  Input parse_tree = jshell_parser_parse(&parser, command);
   if (parse_tree == NULL) {
     fprintf(stderr, "jshell: AI generated invalid command: %s\n", command);
+    jshell_parser_destroy(&parser);
     free(command);
     return;
   }
 
   interpretInput(parse_tree);
-  free_Input(parse_tree);
+  jshell_parser_destroy(&parser);
   free(command);
 }
 
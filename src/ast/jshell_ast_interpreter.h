@@ -3,14 +3,22 @@
 #ifndef JSHELL_AST_INTERPRETER_H
 #define JSHELL_AST_INTERPRETER_H
 
-#include <wordexp.h>
+#include <stdio.h>
+
 #include "Absyn.h"
+#include "jshell/jshell_cmd_registry.h"
+#include "jshell/jshell_sched.h"
+#include "jshell/jshell_spool.h"
+#include "jshell/jshell_usage.h"
+#include "jshell_ast_plan.h"
+#include "jshell_ast_expand.h"
 
 
 typedef struct {
   int argc;
   char **argv;
-  wordexp_t word_expansion;
+  JShellWords word_expansion;
+  const jshell_cmd_spec_t* spec;  // Registry entry for argv[0], or NULL
 } JShellCmdParams;
 
 
@@ -26,11 +34,27 @@ typedef enum {
 } ExecJobType;
 
 
+// How a job that starts with the `time` prefix reports its usage
+typedef enum {
+  TIME_OFF,
+  TIME_TEXT,
+  TIME_JSON
+} ExecTimeMode;
+
+
 typedef struct {
   ExecJobType exec_job_type;
   JShellCmdVector* jshell_cmd_vector_ptr;
   int input_fd;
   int output_fd;
+  FILE* output_stream;        // Written by the last stage instead of
+                              // output_fd (-1 then), or NULL
+  ExecTimeMode time_mode;
+  uint64_t time_start;        // jshell_usage_now() when the stages started
+  JShellUsage* stage_usage;   // One per stage while timed, else NULL
+  JShellSched sched;          // Placement of the job's processes (`run`)
+  JShellSpool* spool;         // Keeps a background job's output, until
+                              // handed to its job table entry, or NULL
 } JShellExecJob;
 
 typedef enum {
@@ -47,4 +71,6 @@ typedef struct {
 
 int interpretInput(Input p);
 
+int jshell_exec_plan(const JShellPlan* plan);
+
 #endif
@@ -0,0 +1,336 @@
+/**
+ * @file jshell_ast_opt.c
+ * @brief Peephole rewrites of pipelines before they run.
+ *
+ * Agents write pipelines such as `cat f | rg x` or `rg x f | head -n 5`
+ * where a stage only moves bytes another stage could read itself. The
+ * pass works on the expanded stages of a job, so the rewrite sees the
+ * words the commands would get, and only touches linked apps whose
+ * options are listed below as producing the same output from a named
+ * file as from a pipe. Anything else is left alone.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "jshell/jshell_register_externals.h"
+#include "jshell/jshell_trace.h"
+#include "jshell/jshell_vars.h"
+#include "utils/jbox_utils.h"
+
+#include "jshell_ast_opt.h"
+
+
+/** Lines head prints without -n */
+#define OPT_HEAD_DEFAULT_LINES 10
+
+
+/** A command the pass knows the arguments of */
+typedef struct {
+  const char* name;
+  const char* const* flags;        /* Flags allowed in a rewrite */
+  const char* const* value_flags;  /* Those of flags taking a value */
+  int operands;                    /* Positional words before files */
+} OptCommand;
+
+
+static const char* const RG_FLAGS[] = {
+  "-n", "-i", "-w", "-C", "--fixed-strings", "-o", "--only-matching", NULL
+};
+static const char* const HEAD_FLAGS[] = { "-n", "-c", "--bytes", NULL };
+static const char* const TAIL_FLAGS[] = { "-n", NULL };
+static const char* const COUNT_FLAGS[] = { "-C", "-n", "-c", "--bytes",
+                                           NULL };
+
+/** Commands a `cat FILE` stage can hand its file to */
+static const OptCommand FILE_READERS[] = {
+  { "rg", RG_FLAGS, COUNT_FLAGS, 1 },
+  { "head", HEAD_FLAGS, COUNT_FLAGS, 0 },
+  { "tail", TAIL_FLAGS, COUNT_FLAGS, 0 },
+};
+
+#define OPT_RG (&FILE_READERS[0])
+#define OPT_HEAD (&FILE_READERS[1])
+
+
+/**
+ * Tell whether a word is in a NULL-terminated list.
+ * @param list The list.
+ * @param word The word.
+ * @return true if listed.
+ */
+static bool in_list(const char* const* list, const char* word) {
+  for (size_t i = 0; list[i] != NULL; i++) {
+    if (strcmp(list[i], word) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+/**
+ * Tell whether a stage runs a given linked app.
+ * @param stage The stage.
+ * @param name App name.
+ * @return true if the stage runs the app linked into jbox.
+ */
+static bool stage_is(const JShellCmdParams* stage, const char* name) {
+  return stage->spec != NULL
+         && jshell_is_linked_command(stage->spec)
+         && strcmp(stage->spec->name, name) == 0;
+}
+
+
+/**
+ * Check the arguments of a stage against a command's allowed flags.
+ * @param stage The stage.
+ * @param cmd The command it runs.
+ * @param files Set to the number of file operands.
+ * @return true if every flag is allowed and the operands are there.
+ */
+static bool scan_stage(const JShellCmdParams* stage, const OptCommand* cmd,
+                       int* files) {
+  int positional = 0;
+  for (int i = 1; i < stage->argc; i++) {
+    const char* arg = stage->argv[i];
+    if (arg[0] != '-' || arg[1] == '\0') {
+      positional++;
+      continue;
+    }
+    if (!in_list(cmd->flags, arg)) {
+      return false;
+    }
+    if (in_list(cmd->value_flags, arg) && ++i >= stage->argc) {
+      return false;
+    }
+  }
+  if (positional < cmd->operands) {
+    return false;
+  }
+  *files = positional - cmd->operands;
+  return true;
+}
+
+
+/**
+ * Tell whether a stage has a given argument.
+ * @param stage The stage.
+ * @param word The argument.
+ * @return true if one of the stage's arguments is word.
+ */
+static bool stage_has_word(const JShellCmdParams* stage, const char* word) {
+  for (int i = 1; i < stage->argc; i++) {
+    if (strcmp(stage->argv[i], word) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+/**
+ * Find the line limit of a `head` stage reading its input.
+ * @param stage The stage.
+ * @return Lines head prints, or 0 if it is not such a stage.
+ */
+static long head_line_limit(const JShellCmdParams* stage) {
+  int files;
+  if (!stage_is(stage, OPT_HEAD->name)
+      || !scan_stage(stage, OPT_HEAD, &files) || files > 0) {
+    return 0;
+  }
+
+  long limit = OPT_HEAD_DEFAULT_LINES;
+  for (int i = 1; i + 1 < stage->argc; i++) {
+    const char* arg = stage->argv[i];
+    if (strcmp(arg, "-c") == 0 || strcmp(arg, "--bytes") == 0) {
+      return 0;
+    }
+    if (strcmp(arg, "-n") == 0) {
+      char* end;
+      errno = 0;
+      limit = strtol(stage->argv[++i], &end, 10);
+      if (errno != 0 || *end != '\0' || limit <= 0 || limit > INT_MAX) {
+        return 0;
+      }
+    }
+  }
+  return limit;
+}
+
+
+/**
+ * Add a word at the end of a stage's arguments.
+ * @param stage The stage.
+ * @param word The word, copied.
+ * @return 0 on success, -1 if the stage was left as it was.
+ */
+static int stage_append(JShellCmdParams* stage, const char* word) {
+  JShellWords* words = &stage->word_expansion;
+  /* argv is the tail of the expansion (a `time` prefix may be skipped) */
+  size_t offset = (size_t)(stage->argv - words->wordv);
+  if (offset + (size_t)stage->argc != words->wordc
+      || jshell_words_append(words, word) != 0) {
+    return -1;
+  }
+  stage->argv = words->wordv + offset;
+  stage->argc++;
+  return 0;
+}
+
+
+/**
+ * Remove a stage from a job.
+ * @param cmd_vector The job's stages.
+ * @param index Stage to remove.
+ */
+static void remove_stage(JShellCmdVector* cmd_vector, size_t index) {
+  JShellCmdParams* stages = cmd_vector->jshell_cmd_params_ptr;
+  jshell_words_free(&stages[index].word_expansion);
+  memmove(&stages[index], &stages[index + 1],
+          (cmd_vector->cmd_count - index - 1) * sizeof(JShellCmdParams));
+  cmd_vector->cmd_count--;
+  memset(&stages[cmd_vector->cmd_count], 0, sizeof(JShellCmdParams));
+}
+
+
+/**
+ * Drop bare `cat` stages that only copy a pipe into another pipe.
+ *
+ * The neighbours then see the same kind of descriptor as before: a pipe
+ * between two stages, or the job's redirection at either end. A cat that
+ * stands for the terminal is kept, since apps format for terminals.
+ *
+ * @param job The job.
+ */
+static void drop_copying_cats(JShellExecJob* job) {
+  JShellCmdVector* cmd_vector = job->jshell_cmd_vector_ptr;
+  size_t i = 0;
+  while (i < cmd_vector->cmd_count && cmd_vector->cmd_count > 1) {
+    JShellCmdParams* stage = &cmd_vector->jshell_cmd_params_ptr[i];
+    size_t last = cmd_vector->cmd_count - 1;
+    bool droppable = stage_is(stage, "cat") && stage->argc == 1
+                     && ((i > 0 && i < last)
+                         || (i == 0 && job->input_fd != -1)
+                         || (i == last && job->output_fd != -1));
+    if (!droppable) {
+      i++;
+      continue;
+    }
+    uint64_t trace_start = jshell_trace_begin();
+    DPRINT("Optimizer: dropping cat stage %zu", i);
+    remove_stage(cmd_vector, i);
+    jshell_trace_end("optimize", "drop cat", trace_start);
+  }
+}
+
+
+/**
+ * Fold a leading `cat FILE` into the stage after it, which reads FILE.
+ *
+ * Only a regular file that can be read is handed over, so errors still
+ * come from the same place and the pipeline's status is unchanged.
+ *
+ * @param job The job.
+ */
+static void fuse_leading_cat(JShellExecJob* job) {
+  JShellCmdVector* cmd_vector = job->jshell_cmd_vector_ptr;
+  if (cmd_vector->cmd_count < 2) {
+    return;
+  }
+  JShellCmdParams* cat = &cmd_vector->jshell_cmd_params_ptr[0];
+  JShellCmdParams* next = &cmd_vector->jshell_cmd_params_ptr[1];
+  if (!stage_is(cat, "cat") || cat->argc != 2 || cat->argv[1][0] == '-') {
+    return;
+  }
+
+  const OptCommand* reader = NULL;
+  size_t reader_count = sizeof(FILE_READERS) / sizeof(FILE_READERS[0]);
+  for (size_t i = 0; i < reader_count && reader == NULL; i++) {
+    if (stage_is(next, FILE_READERS[i].name)) {
+      reader = &FILE_READERS[i];
+    }
+  }
+  int files;
+  if (reader == NULL || !scan_stage(next, reader, &files) || files > 0) {
+    return;
+  }
+
+  const char* path = cat->argv[1];
+  struct stat st;
+  if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)
+      || access(path, R_OK) != 0) {
+    return;
+  }
+
+  uint64_t trace_start = jshell_trace_begin();
+  if (stage_append(next, path) != 0) {
+    return;
+  }
+  DPRINT("Optimizer: cat %s | %s -> %s with file", path, reader->name,
+         reader->name);
+  remove_stage(cmd_vector, 0);
+  jshell_trace_end("optimize", reader == OPT_RG ? "cat|rg"
+                               : reader == OPT_HEAD ? "cat|head"
+                               : "cat|tail", trace_start);
+}
+
+
+/**
+ * Tell `rg` stages feeding `head -n N` to stop after N matching lines.
+ *
+ * Each matching line prints at least one line, so the first N lines rg
+ * prints are the same with --max-count=N; the rest is only read to be
+ * thrown away by head. Not with -C, where a later match would turn from
+ * a match line into a context line.
+ *
+ * @param job The job.
+ */
+static void push_head_limits(JShellExecJob* job) {
+  JShellCmdVector* cmd_vector = job->jshell_cmd_vector_ptr;
+  for (size_t i = 0; i + 1 < cmd_vector->cmd_count; i++) {
+    JShellCmdParams* stage = &cmd_vector->jshell_cmd_params_ptr[i];
+    int files;
+    if (!stage_is(stage, OPT_RG->name)
+        || !scan_stage(stage, OPT_RG, &files)
+        || stage_has_word(stage, "-C")) {
+      continue;
+    }
+    long limit = head_line_limit(&cmd_vector->jshell_cmd_params_ptr[i + 1]);
+    if (limit == 0) {
+      continue;
+    }
+
+    uint64_t trace_start = jshell_trace_begin();
+    char flag[32];
+    snprintf(flag, sizeof(flag), "--max-count=%ld", limit);
+    if (stage_append(stage, flag) == 0) {
+      DPRINT("Optimizer: rg | head -n %ld -> rg %s", limit, flag);
+      jshell_trace_end("optimize", "head limit|rg", trace_start);
+    }
+  }
+}
+
+
+/**
+ * Rewrite the stages of a job into a cheaper pipeline with the same
+ * output, unless JSHELL_NO_OPT is set to something other than 0.
+ * @param job The job, with expanded stages and open redirections.
+ */
+void jshell_optimize_job(JShellExecJob* job) {
+  const char* no_opt = jshell_var_get("JSHELL_NO_OPT");
+  if (no_opt != NULL && no_opt[0] != '\0' && strcmp(no_opt, "0") != 0) {
+    return;
+  }
+
+  drop_copying_cats(job);
+  fuse_leading_cat(job);
+  push_head_limits(job);
+}
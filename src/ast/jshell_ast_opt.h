@@ -0,0 +1,19 @@
+#ifndef JSHELL_AST_OPT_H
+#define JSHELL_AST_OPT_H
+
+#include "jshell_ast_interpreter.h"
+
+
+// Peephole pass over the expanded stages of a job, rewriting wasteful
+// pipeline shapes into fewer stages with the same output:
+//   cat FILE | rg|head|tail ARGS  ->  rg|head|tail ARGS FILE
+//   ... | cat | ...               ->  ... | ...  (bare cat between stages)
+//   rg ARGS | head -n N           ->  rg ARGS --max-count=N | head -n N
+// Only linked apps with options known to behave the same on a file and
+// a pipe are touched. Set JSHELL_NO_OPT=1 to turn the pass off; each
+// rewrite is recorded as an "optimize" trace event
+// Call once the stages are expanded and the redirections opened
+void jshell_optimize_job(JShellExecJob* job);
+
+
+#endif
@@ -0,0 +1,47 @@
+/**
+ * @file jshell_ast_parser.c
+ * @brief Reentrant entry point to the generated parser.
+ *
+ * psInput() from the BNFC output creates a scanner per call and passes
+ * it and the result through the parser's arguments, so it has no global
+ * state of its own. What was shared is where the tree's memory comes
+ * from; a JShellParser makes its arena current only around its own
+ * psInput() call, and the current arena is per thread.
+ */
+
+#include "Parser.h"
+
+#include "jshell_ast_parser.h"
+
+
+/**
+ * Parse a command line into a tree owned by the parser.
+ * @param parser Parser context; not shared between threads.
+ * @param str Command line text.
+ * @return Parse tree, or NULL on a syntax error.
+ */
+Input jshell_parser_parse(JShellParser* parser, const char* str) {
+  jshell_ast_arena_reset(&parser->arena);
+  JShellAstArena* previous = jshell_ast_arena_begin(&parser->arena);
+  Input tree = psInput(str);
+  jshell_ast_arena_end(previous);
+  return tree;
+}
+
+
+/**
+ * Drop the last tree, keeping memory for the next parse.
+ * @param parser Parser context.
+ */
+void jshell_parser_reset(JShellParser* parser) {
+  jshell_ast_arena_reset(&parser->arena);
+}
+
+
+/**
+ * Drop the last tree and release the parser's memory.
+ * @param parser Parser context; it is left empty and reusable.
+ */
+void jshell_parser_destroy(JShellParser* parser) {
+  jshell_ast_arena_destroy(&parser->arena);
+}
@@ -0,0 +1,29 @@
+#ifndef JSHELL_AST_PARSER_H
+#define JSHELL_AST_PARSER_H
+
+#include "Absyn.h"
+#include "jshell_ast_arena.h"
+
+
+// Parser context of one session or thread. The generated parser is pure
+// (bison api.pure with a reentrant flex scanner; the bnfc target refuses
+// anything else) and each context builds its trees in its own arena, so
+// contexts on different threads parse concurrently without a lock
+typedef struct {
+  JShellAstArena arena;
+} JShellParser;
+
+
+// Parse str with parser. The tree is owned by the parser and stays valid
+// until the next parse, reset or destroy on it; it must not be passed to
+// free_Input(). Returns NULL on a syntax error
+Input jshell_parser_parse(JShellParser* parser, const char* str);
+
+// Drop the last tree, keeping the arena's memory for the next parse
+void jshell_parser_reset(JShellParser* parser);
+
+// Drop the last tree and release all of the parser's memory
+void jshell_parser_destroy(JShellParser* parser);
+
+
+#endif
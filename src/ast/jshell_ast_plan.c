@@ -0,0 +1,599 @@
+/**
+ * @file jshell_ast_plan.c
+ * @brief Lowering of BNFC parse trees into flat execution plans.
+ *
+ * A plan is the parse tree reduced to what execution needs: jobs, each
+ * with a contiguous array of pipeline stages, each stage with its
+ * unexpanded words. It is built in a single walk of the tree and packed
+ * into one allocation that owns copies of all token text, so the tree can
+ * be freed as soon as the plan exists and a cached plan costs one block.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "utils/jbox_utils.h"
+
+#include "jshell_ast_plan.h"
+
+
+#define PLAN_NO_WORD SIZE_MAX
+
+
+/** Job while building; indices refer to the builder arrays */
+typedef struct {
+  JShellPlanJobKind kind;
+  size_t first_stage;
+  size_t stage_count;
+  size_t assign_name;
+  size_t input_redir;
+  size_t output_redir;
+  size_t ai_text;      /* Offset into the text buffer */
+} BuildJob;
+
+
+/** Stage while building */
+typedef struct {
+  size_t first_word;
+  size_t word_count;
+} BuildStage;
+
+
+/** Word while building */
+typedef struct {
+  JShellPlanWordKind kind;
+  size_t text;         /* Offset into the text buffer */
+} BuildWord;
+
+
+/** Growable arrays filled during the walk of the parse tree */
+typedef struct {
+  BuildJob* jobs;
+  size_t job_count;
+  size_t job_cap;
+  BuildStage* stages;
+  size_t stage_count;
+  size_t stage_cap;
+  BuildWord* words;
+  size_t word_count;
+  size_t word_cap;
+  char* text;
+  size_t text_len;
+  size_t text_cap;
+  bool failed;
+} PlanBuilder;
+
+
+/**
+ * Make room for one more element in a builder array.
+ * @param data Array pointer (updated on growth).
+ * @param cap Capacity in elements (updated on growth).
+ * @param count Elements in use.
+ * @param need Elements that must fit after count.
+ * @param elem_size Size of one element.
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int builder_reserve(void** data, size_t* cap, size_t count,
+                           size_t need, size_t elem_size) {
+  if (count + need <= *cap) {
+    return 0;
+  }
+
+  size_t new_cap = (*cap == 0) ? 8 : *cap * 2;
+  while (new_cap < count + need) {
+    new_cap *= 2;
+  }
+
+  void* grown = realloc(*data, new_cap * elem_size);
+  if (grown == NULL) {
+    return -1;
+  }
+  *data = grown;
+  *cap = new_cap;
+  return 0;
+}
+
+
+/**
+ * Copy a token's text into the builder's text buffer.
+ * @param b Builder.
+ * @param s Text to copy.
+ * @return Offset of the copy, or 0 (after setting b->failed) on failure.
+ */
+static size_t builder_add_text(PlanBuilder* b, const char* s) {
+  size_t len = strlen(s) + 1;
+  if (builder_reserve((void**)&b->text, &b->text_cap, b->text_len, len,
+                      1) != 0) {
+    b->failed = true;
+    return 0;
+  }
+  size_t offset = b->text_len;
+  memcpy(b->text + offset, s, len);
+  b->text_len += len;
+  return offset;
+}
+
+
+/**
+ * Append a shell token as a plan word.
+ * @param b Builder.
+ * @param token Parse tree token.
+ * @return Index of the word, or PLAN_NO_WORD on failure.
+ */
+static size_t builder_add_word(PlanBuilder* b, ShellToken token) {
+  JShellPlanWordKind kind;
+  const char* text;
+
+  switch (token->kind) {
+  case is_ExpStr:
+    kind = PLAN_WORD_EXPANSION_STRING;
+    text = token->u.expStr_.expansionstringtoken_;
+    break;
+  case is_LitStr:
+    kind = PLAN_WORD_LITERAL_STRING;
+    text = token->u.litStr_.literalstringtoken_;
+    break;
+  case is_Var:
+    kind = PLAN_WORD_VARIABLE;
+    text = token->u.var_.variabletoken_;
+    break;
+  case is_Wrd:
+    kind = PLAN_WORD_WORD;
+    text = token->u.wrd_.wordtoken_;
+    break;
+  default:
+    fprintf(stderr, "Error: bad kind field when lowering ShellToken!\n");
+    b->failed = true;
+    return PLAN_NO_WORD;
+  }
+
+  if (builder_reserve((void**)&b->words, &b->word_cap, b->word_count, 1,
+                      sizeof(BuildWord)) != 0) {
+    b->failed = true;
+    return PLAN_NO_WORD;
+  }
+
+  size_t offset = builder_add_text(b, text);
+  if (b->failed) {
+    return PLAN_NO_WORD;
+  }
+
+  b->words[b->word_count].kind = kind;
+  b->words[b->word_count].text = offset;
+  return b->word_count++;
+}
+
+
+/**
+ * Append the stages of a command line to the current job.
+ * @param b Builder.
+ * @param job Job being built.
+ * @param line Parse tree command line.
+ */
+static void builder_add_command_line(PlanBuilder* b, BuildJob* job,
+                                     CommandLine line) {
+  job->first_stage = b->stage_count;
+
+  for (CommandPart part = line->u.cmdLine_.commandpart_; part != NULL;) {
+    CommandUnit unit;
+    CommandPart next;
+    if (part->kind == is_SnglCmd) {
+      unit = part->u.snglCmd_.commandunit_;
+      next = NULL;
+    } else {
+      unit = part->u.pipeCmd_.commandunit_;
+      next = part->u.pipeCmd_.commandpart_;
+    }
+
+    if (builder_reserve((void**)&b->stages, &b->stage_cap, b->stage_count,
+                        1, sizeof(BuildStage)) != 0) {
+      b->failed = true;
+      return;
+    }
+    BuildStage* stage = &b->stages[b->stage_count++];
+    stage->first_word = b->word_count;
+    stage->word_count = 0;
+
+    for (ListShellToken list = unit->u.cmdUnit_.listshelltoken_;
+         list != NULL; list = list->listshelltoken_) {
+      if (builder_add_word(b, list->shelltoken_) == PLAN_NO_WORD) {
+        return;
+      }
+      stage->word_count++;
+    }
+
+    job->stage_count++;
+    part = next;
+  }
+
+  OptionalInputRedirection in = line->u.cmdLine_.optionalinputredirection_;
+  if (in->kind == is_InRedir) {
+    job->input_redir = builder_add_word(b, in->u.inRedir_.shelltoken_);
+  }
+
+  OptionalOutputRedirection out =
+    line->u.cmdLine_.optionaloutputredirection_;
+  if (out->kind == is_OutRedir) {
+    job->output_redir = builder_add_word(b, out->u.outRedir_.shelltoken_);
+  }
+}
+
+
+/**
+ * Append one job of the parse tree.
+ * @param b Builder.
+ * @param p Parse tree job.
+ */
+static void builder_add_job(PlanBuilder* b, Job p) {
+  if (builder_reserve((void**)&b->jobs, &b->job_cap, b->job_count, 1,
+                      sizeof(BuildJob)) != 0) {
+    b->failed = true;
+    return;
+  }
+
+  BuildJob job = {
+    .assign_name = PLAN_NO_WORD,
+    .input_redir = PLAN_NO_WORD,
+    .output_redir = PLAN_NO_WORD,
+  };
+
+  switch (p->kind) {
+  case is_AssigJob:
+    job.kind = PLAN_ASSIGN_JOB;
+    job.assign_name = builder_add_word(b, p->u.assigJob_.shelltoken_);
+    builder_add_command_line(b, &job, p->u.assigJob_.commandline_);
+    break;
+  case is_FGJob:
+    job.kind = PLAN_FG_JOB;
+    builder_add_command_line(b, &job, p->u.fGJob_.commandline_);
+    break;
+  case is_BGJob:
+    job.kind = PLAN_BG_JOB;
+    builder_add_command_line(b, &job, p->u.bGJob_.commandline_);
+    break;
+  case is_AIChatJob:
+    job.kind = PLAN_AI_CHAT_JOB;
+    job.ai_text = builder_add_text(b, p->u.aIChatJob_.aiquerytoken_);
+    break;
+  case is_AIExecJob:
+    job.kind = PLAN_AI_EXEC_JOB;
+    job.ai_text = builder_add_text(b, p->u.aIExecJob_.aiexectoken_);
+    break;
+  default:
+    fprintf(stderr, "Error: bad kind field when lowering Job!\n");
+    b->failed = true;
+    return;
+  }
+
+  b->jobs[b->job_count++] = job;
+}
+
+
+/**
+ * Pack the builder arrays into a single plan allocation.
+ * @param b Filled builder.
+ * @return Packed plan, or NULL on allocation failure.
+ */
+static JShellPlan* builder_pack(const PlanBuilder* b) {
+  size_t jobs_size = b->job_count * sizeof(JShellPlanJob);
+  size_t stages_size = b->stage_count * sizeof(JShellPlanStage);
+  size_t words_size = b->word_count * sizeof(JShellPlanWord);
+
+  size_t size = sizeof(JShellPlan) + jobs_size + stages_size + words_size
+                + b->text_len;
+  char* block = malloc(size);
+  if (block == NULL) {
+    return NULL;
+  }
+
+  JShellPlan* plan = (JShellPlan*)block;
+  JShellPlanJob* jobs = (JShellPlanJob*)(block + sizeof(JShellPlan));
+  JShellPlanStage* stages = (JShellPlanStage*)((char*)jobs + jobs_size);
+  JShellPlanWord* words = (JShellPlanWord*)((char*)stages + stages_size);
+  char* text = (char*)words + words_size;
+
+  if (b->text_len > 0) {
+    memcpy(text, b->text, b->text_len);
+  }
+
+  for (size_t i = 0; i < b->word_count; i++) {
+    words[i].kind = b->words[i].kind;
+    words[i].text = text + b->words[i].text;
+  }
+
+  for (size_t i = 0; i < b->stage_count; i++) {
+    stages[i].words = words + b->stages[i].first_word;
+    stages[i].word_count = b->stages[i].word_count;
+  }
+
+  for (size_t i = 0; i < b->job_count; i++) {
+    const BuildJob* src = &b->jobs[i];
+    JShellPlanJob* dst = &jobs[i];
+    dst->kind = src->kind;
+    dst->stages = stages + src->first_stage;
+    dst->stage_count = src->stage_count;
+    dst->assign_name = (src->assign_name == PLAN_NO_WORD)
+                       ? NULL : words + src->assign_name;
+    dst->input_redir = (src->input_redir == PLAN_NO_WORD)
+                       ? NULL : words + src->input_redir;
+    dst->output_redir = (src->output_redir == PLAN_NO_WORD)
+                        ? NULL : words + src->output_redir;
+    dst->ai_text = (src->kind == PLAN_AI_CHAT_JOB
+                    || src->kind == PLAN_AI_EXEC_JOB)
+                   ? text + src->ai_text : NULL;
+  }
+
+  plan->jobs = jobs;
+  plan->job_count = b->job_count;
+  plan->size = size;
+  return plan;
+}
+
+
+/**
+ * Lower a parse tree into a flat execution plan.
+ *
+ * The plan copies all token text it needs, so the parse tree may be freed
+ * once this returns.
+ *
+ * @param input Parse tree from psInput().
+ * @return Plan owning a single allocation, or NULL on failure.
+ */
+JShellPlan* jshell_plan_build(Input input) {
+  if (input == NULL || input->kind != is_In) {
+    return NULL;
+  }
+
+  PlanBuilder b = {0};
+  for (ListJob list = input->u.in_.listjob_; list != NULL && !b.failed;
+       list = list->listjob_) {
+    builder_add_job(&b, list->job_);
+  }
+
+  JShellPlan* plan = b.failed ? NULL : builder_pack(&b);
+  if (plan == NULL) {
+    fprintf(stderr, "jshell: failed to build execution plan\n");
+  } else {
+    DPRINT("Built plan: %zu jobs, %zu stages, %zu words",
+           b.job_count, b.stage_count, b.word_count);
+  }
+
+  free(b.jobs);
+  free(b.stages);
+  free(b.words);
+  free(b.text);
+  return plan;
+}
+
+
+/**
+ * Free a plan returned by jshell_plan_build().
+ * @param plan Plan to free (may be NULL).
+ */
+void jshell_plan_free(JShellPlan* plan) {
+  free(plan);
+}
+
+
+/** Offset of a pointer into a plan block, or SIZE_MAX for NULL */
+#define PLAN_OFFSET(base, ptr) \
+  ((ptr) == NULL ? SIZE_MAX : (size_t)((const char*)(ptr) - (base)))
+
+
+/**
+ * Copy a plan with its pointers replaced by offsets from its start.
+ *
+ * The layout of the block is kept, so jshell_plan_relocate() only has to
+ * add the new base address back.
+ *
+ * @param plan Plan from jshell_plan_build().
+ * @param buf Destination of plan->size bytes.
+ */
+void jshell_plan_serialize(const JShellPlan* plan, void* buf) {
+  const char* base = (const char*)plan;
+  char* out = buf;
+  memcpy(out, plan, plan->size);
+
+  JShellPlan* copy = (JShellPlan*)out;
+  JShellPlanJob* jobs = (JShellPlanJob*)(out + PLAN_OFFSET(base, plan->jobs));
+  for (size_t i = 0; i < plan->job_count; i++) {
+    const JShellPlanJob* job = &plan->jobs[i];
+    for (size_t j = 0; j < job->stage_count; j++) {
+      const JShellPlanStage* stage = &job->stages[j];
+      JShellPlanStage* stage_copy =
+          (JShellPlanStage*)(out + PLAN_OFFSET(base, stage));
+      for (size_t k = 0; k < stage->word_count; k++) {
+        const JShellPlanWord* word = &stage->words[k];
+        JShellPlanWord* word_copy =
+            (JShellPlanWord*)(out + PLAN_OFFSET(base, word));
+        word_copy->text = (char*)(uintptr_t)PLAN_OFFSET(base, word->text);
+      }
+      stage_copy->words =
+          (const JShellPlanWord*)(uintptr_t)PLAN_OFFSET(base, stage->words);
+    }
+    /* Redirection and assignment words are in the word array too, but
+     * not always in a stage; fix their text through the job */
+    const JShellPlanWord* extra[] = {
+      job->assign_name, job->input_redir, job->output_redir
+    };
+    for (size_t e = 0; e < sizeof(extra) / sizeof(extra[0]); e++) {
+      if (extra[e] != NULL) {
+        JShellPlanWord* word_copy =
+            (JShellPlanWord*)(out + PLAN_OFFSET(base, extra[e]));
+        word_copy->text = (char*)(uintptr_t)PLAN_OFFSET(base, extra[e]->text);
+      }
+    }
+    jobs[i].stages =
+        (const JShellPlanStage*)(uintptr_t)PLAN_OFFSET(base, job->stages);
+    jobs[i].assign_name =
+        (const JShellPlanWord*)(uintptr_t)PLAN_OFFSET(base, job->assign_name);
+    jobs[i].input_redir =
+        (const JShellPlanWord*)(uintptr_t)PLAN_OFFSET(base, job->input_redir);
+    jobs[i].output_redir =
+        (const JShellPlanWord*)(uintptr_t)PLAN_OFFSET(base, job->output_redir);
+    jobs[i].ai_text = (char*)(uintptr_t)PLAN_OFFSET(base, job->ai_text);
+  }
+  copy->jobs = (const JShellPlanJob*)(uintptr_t)PLAN_OFFSET(base, plan->jobs);
+}
+
+
+/**
+ * Check an offset of a serialized plan and turn it into a pointer.
+ * @param block Start of the block.
+ * @param size Size of the block.
+ * @param offset Offset stored in place of the pointer.
+ * @param start First byte the pointed-to data may start at.
+ * @param count Elements the pointer must cover.
+ * @param elem_size Size of one element (alignment is checked against it).
+ * @param ptr Set to the pointer, or NULL for a NULL offset.
+ * @return true if the offset is SIZE_MAX (NULL) or a valid range.
+ */
+static bool relocate_range(char* block, size_t size, uintptr_t offset,
+                           size_t start, size_t count, size_t elem_size,
+                           void** ptr) {
+  if (offset == SIZE_MAX) {
+    *ptr = NULL;
+    return true;
+  }
+  if (offset < start || offset > size || offset % _Alignof(size_t) != 0
+      || count > (size - offset) / elem_size) {
+    return false;
+  }
+  *ptr = block + offset;
+  return true;
+}
+
+
+/**
+ * Check a text offset of a serialized plan and turn it into a pointer.
+ * @param block Start of the block.
+ * @param size Size of the block.
+ * @param text_start Offset of the text area.
+ * @param offset Offset stored in place of the pointer.
+ * @param text Set to the string, or NULL for a NULL offset.
+ * @return true if the offset is NULL or a terminated string in the text.
+ */
+static bool relocate_text(char* block, size_t size, size_t text_start,
+                          uintptr_t offset, char** text) {
+  if (offset == SIZE_MAX) {
+    *text = NULL;
+    return true;
+  }
+  if (offset < text_start || offset >= size
+      || memchr(block + offset, '\0', size - offset) == NULL) {
+    return false;
+  }
+  *text = block + offset;
+  return true;
+}
+
+
+/**
+ * Relocate a serialized plan in place.
+ *
+ * Every offset is checked against the layout builder_pack() produces
+ * (jobs, then stages, then words, then text), so a damaged block is
+ * refused rather than followed.
+ *
+ * @param block Block written by jshell_plan_serialize(); must be writable
+ *              and aligned like malloc() memory.
+ * @param size Size of the block.
+ * @return The plan at the start of the block, or NULL if malformed.
+ */
+const JShellPlan* jshell_plan_relocate(void* block, size_t size) {
+  char* base = block;
+  if (size < sizeof(JShellPlan)) {
+    return NULL;
+  }
+
+  JShellPlan* plan = block;
+  if (plan->size != size
+      || plan->job_count > (size - sizeof(JShellPlan))
+                           / sizeof(JShellPlanJob)) {
+    return NULL;
+  }
+
+  void* ptr;
+  if ((uintptr_t)plan->jobs != sizeof(JShellPlan)) {
+    return NULL;
+  }
+  plan->jobs = (JShellPlanJob*)(base + sizeof(JShellPlan));
+  JShellPlanJob* jobs = (JShellPlanJob*)plan->jobs;
+  size_t stages_start = sizeof(JShellPlan)
+                        + plan->job_count * sizeof(JShellPlanJob);
+
+  /* Find where the words end (and the text starts) from the jobs */
+  size_t stage_end = stages_start;
+  size_t word_start = SIZE_MAX;
+  size_t word_end = 0;
+  for (size_t i = 0; i < plan->job_count; i++) {
+    uintptr_t offset = (uintptr_t)jobs[i].stages;
+    if (!relocate_range(base, size, offset, stages_start,
+                        jobs[i].stage_count, sizeof(JShellPlanStage), &ptr)
+        || ptr == NULL) {
+      return NULL;
+    }
+    jobs[i].stages = ptr;
+    size_t end = offset + jobs[i].stage_count * sizeof(JShellPlanStage);
+    stage_end = end > stage_end ? end : stage_end;
+  }
+  for (size_t i = 0; i < plan->job_count; i++) {
+    for (size_t j = 0; j < jobs[i].stage_count; j++) {
+      JShellPlanStage* stage = (JShellPlanStage*)&jobs[i].stages[j];
+      uintptr_t offset = (uintptr_t)stage->words;
+      if (!relocate_range(base, size, offset, stage_end, stage->word_count,
+                          sizeof(JShellPlanWord), &ptr)
+          || ptr == NULL) {
+        return NULL;
+      }
+      stage->words = ptr;
+      size_t end = offset + stage->word_count * sizeof(JShellPlanWord);
+      word_start = offset < word_start ? offset : word_start;
+      word_end = end > word_end ? end : word_end;
+    }
+    const JShellPlanWord** extra[] = {
+      &jobs[i].assign_name, &jobs[i].input_redir, &jobs[i].output_redir
+    };
+    for (size_t e = 0; e < sizeof(extra) / sizeof(extra[0]); e++) {
+      uintptr_t offset = (uintptr_t)*extra[e];
+      if (!relocate_range(base, size, offset, stage_end, 1,
+                          sizeof(JShellPlanWord), &ptr)) {
+        return NULL;
+      }
+      *extra[e] = ptr;
+      if (ptr != NULL) {
+        size_t end = offset + sizeof(JShellPlanWord);
+        word_start = offset < word_start ? offset : word_start;
+        word_end = end > word_end ? end : word_end;
+      }
+    }
+  }
+
+  /* Words are relocated once each through the word array */
+  size_t text_start = word_end > stage_end ? word_end : stage_end;
+  if (word_start != SIZE_MAX) {
+    if ((word_start - stage_end) % sizeof(JShellPlanWord) != 0) {
+      return NULL;
+    }
+    for (size_t offset = word_start; offset < word_end;
+         offset += sizeof(JShellPlanWord)) {
+      JShellPlanWord* word = (JShellPlanWord*)(base + offset);
+      if (!relocate_text(base, size, text_start, (uintptr_t)word->text,
+                         &word->text)
+          || word->text == NULL) {
+        return NULL;
+      }
+    }
+  }
+  for (size_t i = 0; i < plan->job_count; i++) {
+    if (!relocate_text(base, size, text_start, (uintptr_t)jobs[i].ai_text,
+                       &jobs[i].ai_text)) {
+      return NULL;
+    }
+  }
+
+  return plan;
+}
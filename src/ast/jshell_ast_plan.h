@@ -0,0 +1,78 @@
+#ifndef JSHELL_AST_PLAN_H
+#define JSHELL_AST_PLAN_H
+
+#include <stddef.h>
+
+#include "Absyn.h"
+
+
+// How a plan word is expanded (mirrors the ShellToken kinds)
+typedef enum {
+  PLAN_WORD_EXPANSION_STRING,
+  PLAN_WORD_LITERAL_STRING,
+  PLAN_WORD_VARIABLE,
+  PLAN_WORD_WORD
+} JShellPlanWordKind;
+
+
+// One unexpanded shell word
+typedef struct {
+  JShellPlanWordKind kind;
+  char* text;
+} JShellPlanWord;
+
+
+// One pipeline stage: the words that expand to its argv
+typedef struct {
+  const JShellPlanWord* words;
+  size_t word_count;
+} JShellPlanStage;
+
+
+typedef enum {
+  PLAN_FG_JOB,
+  PLAN_BG_JOB,
+  PLAN_ASSIGN_JOB,
+  PLAN_AI_CHAT_JOB,
+  PLAN_AI_EXEC_JOB
+} JShellPlanJobKind;
+
+
+// One job of a command line (the parts between ';')
+typedef struct {
+  JShellPlanJobKind kind;
+  const JShellPlanStage* stages;
+  size_t stage_count;
+  const JShellPlanWord* assign_name;   // PLAN_ASSIGN_JOB only
+  const JShellPlanWord* input_redir;   // NULL if no '<'
+  const JShellPlanWord* output_redir;  // NULL if no '>'
+  char* ai_text;                       // AI jobs: token including '@'/'@!'
+} JShellPlanJob;
+
+
+// Flat execution plan for a command line, stored in a single allocation
+typedef struct {
+  const JShellPlanJob* jobs;
+  size_t job_count;
+  size_t size;                         // Bytes of the whole allocation
+} JShellPlan;
+
+
+// Lower a parse tree into a plan that no longer references the tree
+// Returns NULL on allocation failure; free with jshell_plan_free()
+JShellPlan* jshell_plan_build(Input input);
+
+// Free a plan returned by jshell_plan_build()
+void jshell_plan_free(JShellPlan* plan);
+
+// Copy plan into buf (plan->size bytes) with its pointers stored as
+// offsets from the start of the block, for writing to a file
+void jshell_plan_serialize(const JShellPlan* plan, void* buf);
+
+// Turn a block written by jshell_plan_serialize() back into a plan, in
+// place. Returns NULL if the block is malformed; the plan lives as long
+// as the block and is not freed with jshell_plan_free()
+const JShellPlan* jshell_plan_relocate(void* block, size_t size);
+
+
+#endif
@@ -3,14 +3,25 @@
  * @brief FTP server core implementation.
  *
  * This module implements the main FTP server functionality including
- * socket setup, client acceptance, and lifecycle management.
+ * socket setup, the event loops, the transfer workers, and lifecycle
+ * management.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netinet/in.h>
@@ -18,144 +29,923 @@
 
 #include "ftpd.h"
 #include "ftpd_client.h"
+#include "ftpd_data.h"
+#include "ftpd_handoff.h"
+#include "ftpd_path.h"
+#include "ftpd_stats.h"
+#include "ftpd_tls.h"
+
+
+/** Events taken per epoll_wait() call. */
+#define FTPD_EVENTS 64
+
+/** Descriptors kept free of clients, for the server's own use. */
+#define FTPD_RESERVED_FDS 16
+
+/** Descriptors of an event loop: listener, epoll and eventfd. */
+#define FTPD_LOOP_FDS 3
 
 
 /**
- * @brief Add a client to the server's client list.
+ * @brief Give a client a free slot of its loop's client table.
  *
- * Thread-safe addition to the linked list of clients.
+ * Only the loop's thread adds and removes its clients, so this takes
+ * no lock. The caller checks that a slot is free.
  *
- * @param server Pointer to server structure.
+ * @param loop Pointer to event loop.
  * @param client Pointer to client to add.
  */
-static void add_client(ftpd_server_t *server, ftpd_client_t *client) {
-  pthread_mutex_lock(&server->clients_lock);
-  client->next = server->clients;
-  server->clients = client;
-  pthread_mutex_unlock(&server->clients_lock);
+static void add_client(ftpd_loop_t *loop, ftpd_client_t *client) {
+  client->slot = loop->free_slots[--loop->free_count];
+  loop->clients[client->slot] = client;
+  atomic_fetch_add_explicit(&loop->client_count, 1, memory_order_relaxed);
+}
+
+
+/**
+ * @brief Give a client's slot back to the free list.
+ *
+ * @param loop Pointer to event loop.
+ * @param client Pointer to client to remove.
+ */
+static void remove_client(ftpd_loop_t *loop, ftpd_client_t *client) {
+  loop->clients[client->slot] = NULL;
+  loop->free_slots[loop->free_count++] = client->slot;
+  atomic_fetch_sub_explicit(&loop->client_count, 1, memory_order_relaxed);
+}
+
+
+/**
+ * @brief Allocate a loop's client table, every slot free.
+ *
+ * Called once max_clients is final. The free list is a stack, so the
+ * slots last freed, still in cache, are used first.
+ *
+ * @param loop Pointer to event loop, with max_clients set.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int alloc_clients(ftpd_loop_t *loop) {
+  int count = loop->max_clients;
+  loop->clients = calloc((size_t)count, sizeof(*loop->clients));
+  loop->free_slots = malloc((size_t)count * sizeof(*loop->free_slots));
+  if (!loop->clients || !loop->free_slots) {
+    fprintf(stderr, "ftpd: out of memory for the client table\n");
+    return -1;
+  }
+  for (int i = 0; i < count; i++) {
+    loop->free_slots[i] = count - 1 - i;
+  }
+  loop->free_count = count;
+  return 0;
+}
+
+
+/**
+ * @brief Close a client connection and free the client.
+ *
+ * @param loop Pointer to the client's event loop.
+ * @param client Pointer to client to disconnect.
+ */
+static void disconnect_client(ftpd_loop_t *loop, ftpd_client_t *client) {
+  /* Closing the socket also takes it out of the epoll set */
+  ftpd_client_cleanup(client);
+
+  if (client->username[0]) {
+    printf("ftpd: client %s disconnected\n", client->username);
+  } else {
+    printf("ftpd: client disconnected\n");
+  }
+
+  remove_client(loop, client);
+  free(client);
+}
+
+
+/**
+ * @brief Wait for input on a client's control connection.
+ *
+ * @param loop Pointer to the client's event loop.
+ * @param client Pointer to client structure.
+ * @return 0 on success, -1 on error.
+ */
+static int watch_client(ftpd_loop_t *loop, ftpd_client_t *client) {
+  struct epoll_event ev = {
+    .events = EPOLLIN | EPOLLRDHUP,
+    .data.ptr = client
+  };
+  if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, client->ctrl_fd, &ev) < 0) {
+    perror("ftpd: epoll_ctl");
+    return -1;
+  }
+  return 0;
+}
+
+
+/**
+ * @brief Hand a client's transfer command to the workers.
+ *
+ * The client leaves the epoll set until the command is done, so the
+ * loop's thread does not touch it while a worker does.
+ *
+ * @param loop Pointer to the client's event loop.
+ * @param client Pointer to client with the command in client->job.
+ */
+static void queue_job(ftpd_loop_t *loop, ftpd_client_t *client) {
+  ftpd_server_t *server = loop->server;
+  epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, client->ctrl_fd, NULL);
+  client->busy = true;
+  client->next_job = NULL;
+  client->bulk = ftpd_client_job_is_bulk(client);
+  client->queued_at = ftpd_stats_now();
+
+  pthread_mutex_lock(&server->jobs_lock);
+  ftpd_client_t **head = client->bulk ? &server->bulk_jobs : &server->jobs;
+  ftpd_client_t **tail = client->bulk ? &server->bulk_tail
+                                      : &server->jobs_tail;
+  if (*tail) {
+    (*tail)->next_job = client;
+  } else {
+    *head = client;
+  }
+  *tail = client;
+  pthread_cond_signal(&server->jobs_cond);
+  pthread_mutex_unlock(&server->jobs_lock);
 }
 
 
 /**
- * @brief Remove a client from the server's client list.
+ * @brief Take the next job for a worker.
  *
- * Thread-safe removal from the linked list of clients.
+ * A quick job comes first. Otherwise, if a bulk slot is free, the
+ * oldest bulk job of the peer with the fewest bulk jobs running is
+ * taken and the peer counted. Called with jobs_lock held.
  *
  * @param server Pointer to server structure.
- * @param client Pointer to client to remove.
+ * @return Client whose job to run, or NULL if none may run now.
  */
-static void remove_client(ftpd_server_t *server, ftpd_client_t *client) {
-  pthread_mutex_lock(&server->clients_lock);
+static ftpd_client_t *take_job(ftpd_server_t *server) {
+  ftpd_client_t *client = server->jobs;
+  if (client) {
+    server->jobs = client->next_job;
+    if (!server->jobs) {
+      server->jobs_tail = NULL;
+    }
+    return client;
+  }
+
+  if (server->bulk_running >= server->bulk_limit) {
+    return NULL;
+  }
+
+  ftpd_client_t *prev = NULL, *best_prev = NULL, *best = NULL;
+  int best_load = server->bulk_running + 1;
+  for (client = server->bulk_jobs; client && best_load > 0;
+       prev = client, client = client->next_job) {
+    int load = 0;
+    for (int i = 0; i < server->bulk_running; i++) {
+      load += server->bulk_peers[i] == client->peer_addr;
+    }
+    if (load < best_load) {
+      best_load = load;
+      best = client;
+      best_prev = prev;
+    }
+  }
+  if (!best) {
+    return NULL;
+  }
 
-  ftpd_client_t **pp = &server->clients;
-  while (*pp) {
-    if (*pp == client) {
-      *pp = client->next;
+  if (best_prev) {
+    best_prev->next_job = best->next_job;
+  } else {
+    server->bulk_jobs = best->next_job;
+  }
+  if (server->bulk_tail == best) {
+    server->bulk_tail = best_prev;
+  }
+  server->bulk_peers[server->bulk_running++] = best->peer_addr;
+  return best;
+}
+
+
+/**
+ * @brief Give back the bulk slot of a finished job. Called with
+ *        jobs_lock held.
+ *
+ * @param server Pointer to server structure.
+ * @param client Client whose bulk job has finished.
+ */
+static void release_bulk(ftpd_server_t *server, ftpd_client_t *client) {
+  for (int i = 0; i < server->bulk_running; i++) {
+    if (server->bulk_peers[i] == client->peer_addr) {
+      server->bulk_peers[i] = server->bulk_peers[--server->bulk_running];
       break;
     }
-    pp = &(*pp)->next;
   }
+}
 
-  pthread_mutex_unlock(&server->clients_lock);
+
+/**
+ * @brief Dispatch the commands a client has sent.
+ *
+ * @param loop Pointer to the client's event loop.
+ * @param client Pointer to client structure.
+ * @param eof Whether the client has closed the connection.
+ * @return 0 to keep the client, -1 to disconnect it.
+ */
+static int serve_client(ftpd_loop_t *loop, ftpd_client_t *client, bool eof) {
+  int rc = ftpd_client_process(client, eof);
+  if (rc < 0) {
+    return -1;
+  }
+  if (rc > 0) {
+    /* An EOF is seen again once the client is watched again */
+    queue_job(loop, client);
+    return 0;
+  }
+  return eof ? -1 : 0;
 }
 
 
 /**
- * @brief Thread wrapper for client handler.
+ * @brief Handle input on a client's control connection.
  *
- * Wraps the client handler to perform cleanup after disconnection.
+ * @param loop Pointer to the client's event loop.
+ * @param client Pointer to client structure.
+ */
+static void client_event(ftpd_loop_t *loop, ftpd_client_t *client) {
+  /* Input TLS has already taken off the socket raises no event */
+  do {
+    int rc = ftpd_client_read(client);
+    if (rc < 0 || serve_client(loop, client, rc == 0) < 0) {
+      disconnect_client(loop, client);
+      return;
+    }
+  } while (!client->busy && ftpd_tls_pending(client->ctrl_tls));
+}
+
+
+/**
+ * @brief Transfer worker thread.
  *
- * @param arg Pointer to ftpd_client_t structure.
+ * Runs the transfer commands queued by the event loops and hands each
+ * client back through the done list of its loop.
+ *
+ * @param arg Pointer to ftpd_server_t structure.
  * @return NULL always.
  */
-static void *client_thread_wrapper(void *arg) {
-  ftpd_client_t *client = (ftpd_client_t *)arg;
-  ftpd_server_t *server = client->server;
+static void *worker_main(void *arg) {
+  ftpd_server_t *server = (ftpd_server_t *)arg;
+  ftpd_stats_attach(server->stats);
 
-  /* Run the client handler */
-  ftpd_client_handler(arg);
+  pthread_mutex_lock(&server->jobs_lock);
+  while (!server->stopping) {
+    ftpd_client_t *client = take_job(server);
+    if (!client) {
+      pthread_cond_wait(&server->jobs_cond, &server->jobs_lock);
+      continue;
+    }
+    server->active_jobs++;
+    pthread_mutex_unlock(&server->jobs_lock);
 
-  /* Remove from client list and free */
-  remove_client(server, client);
-  free(client);
+    ftpd_stats_time(server->stats, FTPD_TIME_QUEUE,
+                    ftpd_stats_now() - client->queued_at);
+    client->job_result = ftpd_dispatch_command(client, client->job);
+
+    pthread_mutex_lock(&server->jobs_lock);
+    if (client->bulk) {
+      release_bulk(server, client);
+    }
+    ftpd_loop_t *loop = client->loop;
+    client->next_job = loop->done;
+    loop->done = client;
+    server->active_jobs--;
+    /* Idle workers may take a bulk job now; ftpd_cleanup() may be
+       waiting for the last job */
+    pthread_cond_broadcast(&server->jobs_cond);
+    eventfd_write(loop->wake_fd, 1);
+  }
+  pthread_mutex_unlock(&server->jobs_lock);
 
   return NULL;
 }
 
 
+/**
+ * @brief Take back a loop's clients whose transfers have finished.
+ *
+ * @param loop Pointer to event loop.
+ */
+static void finish_jobs(ftpd_loop_t *loop) {
+  ftpd_server_t *server = loop->server;
+  eventfd_t count;
+  eventfd_read(loop->wake_fd, &count);
+
+  pthread_mutex_lock(&server->jobs_lock);
+  ftpd_client_t *client = loop->done;
+  loop->done = NULL;
+  pthread_mutex_unlock(&server->jobs_lock);
+
+  while (client) {
+    ftpd_client_t *next = client->next_job;
+    client->busy = false;
+
+    /* Commands that arrived during the transfer are already buffered */
+    if (client->job_result < 0 ||
+        serve_client(loop, client, false) < 0 ||
+        (!client->busy && watch_client(loop, client) < 0)) {
+      disconnect_client(loop, client);
+    } else if (!client->busy && ftpd_tls_pending(client->ctrl_tls)) {
+      client_event(loop, client);
+    }
+    client = next;
+  }
+}
+
+
 /**
  * @brief Accept a new client connection.
  *
- * Accepts a connection, creates a client structure, and spawns
- * a handler thread.
+ * Accepts a connection, creates a client structure, greets the client
+ * and adds its control connection to the loop's epoll set.
  *
- * @param server Pointer to server structure.
- * @return 0 on success, -1 on error.
+ * @param loop Pointer to event loop.
+ * @return 1 if a connection was handled, 0 when there are none left,
+ *         -1 on error.
  */
-static int accept_client(ftpd_server_t *server) {
+static int accept_client(ftpd_loop_t *loop) {
+  ftpd_server_t *server = loop->server;
   struct sockaddr_in client_addr;
   socklen_t addr_len = sizeof(client_addr);
 
-  int client_fd = accept(server->listen_fd,
-                         (struct sockaddr *)&client_addr,
-                         &addr_len);
+  int client_fd = accept4(loop->listen_fd,
+                          (struct sockaddr *)&client_addr,
+                          &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
   if (client_fd < 0) {
     if (errno == EINTR || errno == ECONNABORTED) {
-      return 0;  /* Non-fatal, try again */
+      return 1;  /* Non-fatal, try again */
     }
-    if (!server->running) {
-      return 0;  /* Server shutting down */
+    if (errno == EAGAIN || errno == EWOULDBLOCK || !server->running) {
+      return 0;  /* No more pending, or server shutting down */
     }
     perror("ftpd: accept");
     return -1;
   }
 
+  if (loop->free_count == 0) {
+    static const char busy[] = "421 Too many connections.\r\n";
+    send(client_fd, busy, sizeof(busy) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(client_fd);
+    ftpd_stats_add(server->stats, FTPD_COUNT_REFUSED, 1);
+    return 1;
+  }
+
   /* Allocate client structure */
   ftpd_client_t *client = calloc(1, sizeof(ftpd_client_t));
   if (!client) {
     fprintf(stderr, "ftpd: out of memory for client\n");
     close(client_fd);
-    return -1;
+    return 1;
   }
 
   /* Initialize client */
   ftpd_client_init(client, client_fd, server);
+  client->loop = loop;
+  client->peer_addr = client_addr.sin_addr.s_addr;
 
-  /* Add to client list */
-  add_client(server, client);
-
-  /* Spawn handler thread */
-  int err = pthread_create(&client->thread, NULL,
-                           client_thread_wrapper, client);
-  if (err != 0) {
-    fprintf(stderr, "ftpd: pthread_create: %s\n", strerror(err));
-    remove_client(server, client);
-    close(client_fd);
-    free(client);
-    return -1;
-  }
-
-  /* Detach thread so it cleans up automatically */
-  pthread_detach(client->thread);
+  /* Add to client table */
+  add_client(loop, client);
+  ftpd_stats_add(server->stats, FTPD_COUNT_CONNECTIONS, 1);
 
   char addr_str[INET_ADDRSTRLEN];
   inet_ntop(AF_INET, &client_addr.sin_addr, addr_str, sizeof(addr_str));
   printf("ftpd: client connected from %s:%d\n",
          addr_str, ntohs(client_addr.sin_port));
 
+  /* Send welcome message */
+  if (ftpd_send_response(client, 220, "jbox FTP server ready.") < 0 ||
+      watch_client(loop, client) < 0) {
+    disconnect_client(loop, client);
+  }
+
+  return 1;
+}
+
+
+/**
+ * @brief Make room for as many descriptors as clients may need.
+ *
+ * Raises the soft descriptor limit to the hard one and lowers
+ * max_clients to what then fits, counting a control and a data
+ * connection and a current directory per client, and the descriptors
+ * of each event loop.
+ *
+ * @param server Pointer to server structure.
+ */
+static void fit_fd_limit(ftpd_server_t *server) {
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) < 0) {
+    return;
+  }
+  if (rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &rl) < 0) {
+      getrlimit(RLIMIT_NOFILE, &rl);
+    }
+  }
+  if (rl.rlim_cur == RLIM_INFINITY) {
+    return;
+  }
+
+  rlim_t reserved = FTPD_RESERVED_FDS +
+                    (rlim_t)server->config.acceptors * FTPD_LOOP_FDS;
+  rlim_t fit = rl.rlim_cur > reserved ? (rl.rlim_cur - reserved) / 3 : 1;
+  if ((rlim_t)server->config.max_clients > fit) {
+    server->config.max_clients = (int)fit;
+  }
+}
+
+
+/**
+ * @brief Start the transfer workers.
+ *
+ * One worker is started for each data transfer that may run at once.
+ * A quarter of them, at least one, are kept from bulk jobs. The
+ * workers block SIGINT and SIGTERM so that the signal handler, which
+ * stops the server, runs on the thread that called ftpd_start().
+ *
+ * @param server Pointer to server structure.
+ * @return 0 if at least one worker started, -1 otherwise.
+ */
+static int start_workers(ftpd_server_t *server) {
+  sigset_t block, old;
+  sigemptyset(&block);
+  sigaddset(&block, SIGINT);
+  sigaddset(&block, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &block, &old);
+
+  for (int i = 0; i < server->config.max_transfers; i++) {
+    int err = pthread_create(&server->workers[server->worker_count], NULL,
+                             worker_main, server);
+    if (err != 0) {
+      fprintf(stderr, "ftpd: pthread_create: %s\n", strerror(err));
+      break;
+    }
+    server->worker_count++;
+  }
+
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  int reserved = server->worker_count / 4;
+  if (reserved < 1) {
+    reserved = 1;
+  }
+  server->bulk_limit = server->worker_count > reserved
+                       ? server->worker_count - reserved : 1;
+  return server->worker_count > 0 ? 0 : -1;
+}
+
+
+
+
+/**
+ * @brief Stop every event loop.
+ *
+ * Called by a loop that ends, so that the others end with it and
+ * ftpd_start() returns only once the server is stopping.
+ *
+ * @param server Pointer to server structure.
+ */
+static void wake_loops(ftpd_server_t *server) {
+  server->running = false;
+  for (int i = 0; i < server->loop_count; i++) {
+    if (server->loops[i].wake_fd >= 0) {
+      eventfd_write(server->loops[i].wake_fd, 1);
+    }
+  }
+}
+
+
+/**
+ * @brief Open a listening socket on the server's port.
+ *
+ * @param server Pointer to server structure.
+ * @param reuse_port Whether other loops listen on the port too, the
+ *        kernel spreading connections over them.
+ * @return The socket, or -1 on error.
+ */
+static int open_listener(ftpd_server_t *server, bool reuse_port) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    perror("ftpd: socket");
+    return -1;
+  }
+
+  /* Allow address reuse */
+  int optval = 1;
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval,
+                 sizeof(optval)) < 0) {
+    perror("ftpd: setsockopt SO_REUSEADDR");
+  }
+  if (reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &optval,
+                               sizeof(optval)) < 0) {
+    perror("ftpd: setsockopt SO_REUSEPORT");
+    close(fd);
+    return -1;
+  }
+
+  /* Bind to port */
+  struct sockaddr_in server_addr = {
+    .sin_family = AF_INET,
+    .sin_addr.s_addr = htonl(INADDR_ANY),
+    .sin_port = htons(server->config.port)
+  };
+
+  if (bind(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+    perror("ftpd: bind");
+    close(fd);
+    return -1;
+  }
+
+  /* Start listening; the client limit is enforced on accept */
+  if (listen(fd, SOMAXCONN) < 0) {
+    perror("ftpd: listen");
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+
+/**
+ * @brief Set up an event loop: its client table, listener and epoll.
+ *
+ * @param server Pointer to server structure.
+ * @param loop Pointer to event loop, counted in loop_count already so
+ *        that ftpd_cleanup() frees what was set up.
+ * @param max_clients The loop's share of the clients.
+ * @param listen_fd Listener taken over from the server being replaced,
+ *        or -1 to open one.
+ * @param shared Whether listeners of the port are bound with
+ *        SO_REUSEPORT.
+ * @return 0 on success, -1 on error.
+ */
+static int open_loop(ftpd_server_t *server, ftpd_loop_t *loop,
+                     int max_clients, int listen_fd, bool shared) {
+  loop->server = server;
+  loop->max_clients = max_clients;
+  loop->listen_fd = listen_fd;
+  if (alloc_clients(loop) < 0) {
+    return -1;
+  }
+
+  if (loop->listen_fd < 0) {
+    loop->listen_fd = open_listener(server, shared);
+  }
+  if (loop->listen_fd < 0) {
+    return -1;
+  }
+
+  loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (loop->epoll_fd < 0 || loop->wake_fd < 0) {
+    perror("ftpd: epoll");
+    return -1;
+  }
+
+  struct epoll_event ev = { .events = EPOLLIN, .data.ptr = loop };
+  if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->listen_fd, &ev) < 0) {
+    perror("ftpd: epoll_ctl");
+    return -1;
+  }
+  ev.data.ptr = &loop->wake_fd;
+  if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &ev) < 0) {
+    perror("ftpd: epoll_ctl");
+    return -1;
+  }
   return 0;
 }
 
 
+/**
+ * @brief Choose a CPU for each event loop.
+ *
+ * With several loops, they take the CPUs the process may run on in
+ * turn, so that each has a core of its own while there are enough. A
+ * single loop is left to the scheduler.
+ *
+ * @param server Pointer to server structure.
+ */
+static void choose_cpus(ftpd_server_t *server) {
+  cpu_set_t allowed;
+  if (server->loop_count < 2 ||
+      sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+    return;
+  }
+  int cpu = -1;
+  for (int i = 0; i < server->loop_count; i++) {
+    do {
+      cpu = (cpu + 1) % CPU_SETSIZE;
+    } while (!CPU_ISSET(cpu, &allowed));
+    server->loops[i].cpu = cpu;
+  }
+}
+
+
+/**
+ * @brief Pin the calling thread to its loop's CPU, if it has one.
+ *
+ * @param loop Pointer to event loop.
+ */
+static void pin_loop(ftpd_loop_t *loop) {
+  if (loop->cpu < 0) {
+    return;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(loop->cpu, &set);
+  int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (err != 0) {
+    fprintf(stderr, "ftpd: pthread_setaffinity_np: %s\n", strerror(err));
+  }
+}
+
+
+/**
+ * @brief Start draining once a new server runs with the listeners.
+ *
+ * Called on the first loop, which watches the handoff sockets.
+ *
+ * @param server Pointer to server structure.
+ */
+static void start_draining(ftpd_server_t *server) {
+  /* The path is the new server's now; only the socket is closed */
+  close(server->handoff_fd);
+  server->handoff_fd = -1;
+  ftpd_stats_stop(server);
+
+  int sessions = 0;
+  for (int i = 0; i < server->loop_count; i++) {
+    sessions += server->loops[i].client_count;
+  }
+  printf("ftpd: handed over; draining %d sessions\n", sessions);
+
+  server->drain_until = ftpd_stats_now() +
+                        (uint64_t)server->config.drain_timeout * 1000000;
+  atomic_store(&server->draining, true);
+  for (int i = 0; i < server->loop_count; i++) {
+    eventfd_write(server->loops[i].wake_fd, 1);
+  }
+}
+
+
+/**
+ * @brief Send a new server the listeners once it connects to the
+ *        handoff socket.
+ *
+ * One new server is served at a time; another is turned away until the
+ * first is running or has failed.
+ *
+ * @param loop Pointer to the first event loop.
+ */
+static void accept_handoff(ftpd_loop_t *loop) {
+  ftpd_server_t *server = loop->server;
+  int conn = accept4(server->handoff_fd, NULL, NULL,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (conn < 0) {
+    return;
+  }
+  if (server->handoff_conn >= 0 || ftpd_handoff_send(server, conn) < 0) {
+    close(conn);
+    return;
+  }
+
+  struct epoll_event ev = { .events = EPOLLIN,
+                            .data.ptr = &server->handoff_conn };
+  if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, conn, &ev) < 0) {
+    perror("ftpd: epoll_ctl");
+    close(conn);
+    return;
+  }
+  server->handoff_conn = conn;
+}
+
+
+/**
+ * @brief Hear from the new server sent the listeners: drain once it
+ *        runs, or go on serving if it ended first.
+ *
+ * @param server Pointer to server structure.
+ */
+static void handoff_reply(ftpd_server_t *server) {
+  char ready;
+  ssize_t n = recv(server->handoff_conn, &ready, 1, 0);
+  if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+    return;
+  }
+  close(server->handoff_conn);
+  server->handoff_conn = -1;
+
+  if (n == 1) {
+    start_draining(server);
+  } else {
+    fprintf(stderr, "ftpd: new server ended before running; "
+            "still serving\n");
+  }
+}
+
+
+/**
+ * @brief Stop a draining loop accepting connections.
+ *
+ * The listener is closed but not shut down: the new server has it.
+ *
+ * @param loop Pointer to event loop.
+ */
+static void stop_accepting(ftpd_loop_t *loop) {
+  epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, loop->listen_fd, NULL);
+  close(loop->listen_fd);
+  loop->listen_fd = -1;
+}
+
+
+/**
+ * @brief End a drained loop's sessions at the drain deadline.
+ *
+ * Idle clients are told to reconnect, which reaches the new server.
+ * Clients a worker is transferring for are left to ftpd_cleanup().
+ *
+ * @param loop Pointer to event loop.
+ */
+static void end_sessions(ftpd_loop_t *loop) {
+  for (int i = 0; i < loop->max_clients; i++) {
+    ftpd_client_t *client = loop->clients[i];
+    if (client && !client->busy) {
+      ftpd_send_response(client, 421, "Server restarting, please "
+                         "reconnect.");
+      disconnect_client(loop, client);
+    }
+  }
+}
+
+
+/**
+ * @brief Run an event loop until the server stops, or until it has
+ *        drained after handing over its listener.
+ *
+ * @param loop Pointer to event loop.
+ */
+static void run_loop(ftpd_loop_t *loop) {
+  ftpd_server_t *server = loop->server;
+  struct epoll_event events[FTPD_EVENTS];
+  while (server->running) {
+    int timeout = -1;
+    if (atomic_load(&server->draining)) {
+      if (loop->listen_fd >= 0) {
+        stop_accepting(loop);
+      }
+      uint64_t now = ftpd_stats_now();
+      if (loop->client_count == 0) {
+        break;
+      }
+      if (now >= server->drain_until) {
+        end_sessions(loop);
+        break;
+      }
+      timeout = (int)((server->drain_until - now + 999) / 1000);
+    }
+
+    int n = epoll_wait(loop->epoll_fd, events, FTPD_EVENTS, timeout);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("ftpd: epoll_wait");
+      break;
+    }
+
+    for (int i = 0; i < n && server->running; i++) {
+      void *ptr = events[i].data.ptr;
+      if (ptr == loop) {
+        if (loop->listen_fd < 0) {
+          continue;  /* Stopped accepting earlier in this batch */
+        }
+        /* Take every pending connection */
+        int rc;
+        do {
+          rc = accept_client(loop);
+        } while (rc > 0);
+        if (rc < 0) {
+          /* Fatal error in accept */
+          server->running = false;
+        }
+      } else if (ptr == &loop->wake_fd) {
+        finish_jobs(loop);
+      } else if (ptr == &server->handoff_fd) {
+        accept_handoff(loop);
+      } else if (ptr == &server->handoff_conn) {
+        handoff_reply(server);
+      } else {
+        client_event(loop, (ftpd_client_t *)ptr);
+      }
+    }
+  }
+
+  /* A draining loop ends alone; the others drain their own clients */
+  if (!atomic_load(&server->draining)) {
+    wake_loops(server);
+  }
+}
+
+
+/**
+ * @brief Thread of an event loop other than the first.
+ *
+ * @param arg Pointer to ftpd_loop_t structure.
+ * @return NULL always.
+ */
+static void *loop_main(void *arg) {
+  ftpd_loop_t *loop = (ftpd_loop_t *)arg;
+  ftpd_stats_attach(loop->server->stats);
+  pin_loop(loop);
+  run_loop(loop);
+  return NULL;
+}
+
+
+/**
+ * @brief Start a thread for each event loop but the first.
+ *
+ * The threads block SIGINT and SIGTERM like the workers.
+ *
+ * @param server Pointer to running server.
+ * @return 0 on success, -1 if a thread could not be started.
+ */
+static int start_loops(ftpd_server_t *server) {
+  sigset_t block, old;
+  sigemptyset(&block);
+  sigaddset(&block, SIGINT);
+  sigaddset(&block, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &block, &old);
+
+  int result = 0;
+  for (int i = 1; i < server->loop_count; i++) {
+    ftpd_loop_t *loop = &server->loops[i];
+    int err = pthread_create(&loop->thread, NULL, loop_main, loop);
+    if (err != 0) {
+      fprintf(stderr, "ftpd: pthread_create: %s\n", strerror(err));
+      result = -1;
+      break;
+    }
+    loop->started = true;
+  }
+
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  return result;
+}
+
+
 int ftpd_init(ftpd_server_t *server, const ftpd_config_t *config) {
   if (!server || !config || !config->root_dir) {
     return -1;
   }
 
   memset(server, 0, sizeof(*server));
-  server->listen_fd = -1;
+  for (int i = 0; i < FTPD_MAX_ACCEPTORS; i++) {
+    server->loops[i].listen_fd = -1;
+    server->loops[i].epoll_fd = -1;
+    server->loops[i].wake_fd = -1;
+    server->loops[i].cpu = -1;
+  }
+  server->root_fd = -1;
+  server->handoff_fd = -1;
+  server->handoff_conn = -1;
   server->config = *config;
   server->running = false;
+  if (server->config.max_clients <= 0) {
+    server->config.max_clients = FTPD_MAX_CLIENTS;
+  }
+  if (server->config.max_transfers <= 0) {
+    server->config.max_transfers = FTPD_WORKERS;
+  }
+  if (server->config.max_transfers > FTPD_MAX_WORKERS) {
+    server->config.max_transfers = FTPD_MAX_WORKERS;
+  }
+  if (server->config.acceptors <= 0) {
+    server->config.acceptors = 1;
+  }
+  if (server->config.acceptors > FTPD_MAX_ACCEPTORS) {
+    server->config.acceptors = FTPD_MAX_ACCEPTORS;
+  }
+  if (server->config.small_file == 0) {
+    server->config.small_file = FTPD_SMALL_FILE;
+  }
+  if (server->config.cache_size == 0) {
+    server->config.cache_size = FTPD_CACHE_SIZE;
+  }
+  if (server->config.drain_timeout <= 0) {
+    server->config.drain_timeout = FTPD_DRAIN_TIMEOUT;
+  }
 
   /* Resolve root directory to absolute path */
   if (!realpath(config->root_dir, server->root_realpath)) {
@@ -165,10 +955,63 @@ int ftpd_init(ftpd_server_t *server, const ftpd_config_t *config) {
     return -1;
   }
 
-  /* Initialize mutex */
-  int err = pthread_mutex_init(&server->clients_lock, NULL);
+  /* Every lookup starts from the root's descriptor */
+  server->root_fd = open(server->root_realpath,
+                         O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (server->root_fd < 0) {
+    perror("ftpd: open root");
+    return -1;
+  }
+  int probe = ftpd_path_open_beneath(server->root_fd, ".", O_PATH, 0);
+  if (probe < 0) {
+    fprintf(stderr, "ftpd: openat2: %s%s\n", strerror(errno),
+            errno == ENOSYS ? " (Linux 5.6 or later is needed)" : "");
+    close(server->root_fd);
+    server->root_fd = -1;
+    return -1;
+  }
+  close(probe);
+
+  /* Validate the passive mode settings */
+  if (config->pasv_address &&
+      inet_pton(AF_INET, config->pasv_address, &server->pasv_addr) != 1) {
+    fprintf(stderr, "ftpd: invalid passive address: %s\n",
+            config->pasv_address);
+    return -1;
+  }
+  if (config->pasv_min_port > config->pasv_max_port) {
+    fprintf(stderr, "ftpd: invalid passive port range\n");
+    return -1;
+  }
+
+  /* Initialize mutexes; with default attributes these cannot fail */
+  int err = pthread_mutex_init(&server->jobs_lock, NULL);
+  if (err == 0) {
+    err = pthread_mutex_init(&server->pasv_lock, NULL);
+  }
+  if (err == 0) {
+    err = pthread_cond_init(&server->jobs_cond, NULL);
+  }
   if (err != 0) {
-    fprintf(stderr, "ftpd: pthread_mutex_init: %s\n", strerror(err));
+    fprintf(stderr, "ftpd: pthread init: %s\n", strerror(err));
+    return -1;
+  }
+  ftpd_bucket_init(&server->total_rate, server->config.total_rate_limit);
+
+  server->stats = ftpd_stats_create();
+  if (!server->stats) {
+    fprintf(stderr, "ftpd: out of memory for statistics\n");
+    return -1;
+  }
+  /* Files counted as small are the ones worth keeping */
+  ftpd_cache_init(&server->cache,
+                  server->config.cache_size > 0
+                  ? (size_t)server->config.cache_size : 0,
+                  server->config.small_file > 0 ? server->config.small_file
+                                                : FTPD_SMALL_FILE);
+
+  /* A bad certificate stops the server here rather than at AUTH */
+  if (ftpd_tls_init(server) < 0) {
     return -1;
   }
 
@@ -181,61 +1024,88 @@ int ftpd_start(ftpd_server_t *server) {
     return -1;
   }
 
-  /* Create listening socket */
-  server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-  if (server->listen_fd < 0) {
-    perror("ftpd: socket");
+  fit_fd_limit(server);
+
+  /* Take over the listeners of the server being replaced, if any */
+  ftpd_handoff_t handoff = { .conn = -1, .stats_fd = -1 };
+  if (server->config.handoff_path &&
+      ftpd_handoff_receive(server, &handoff) < 0) {
     return -1;
   }
-
-  /* Allow address reuse */
-  int optval = 1;
-  if (setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR,
-                 &optval, sizeof(optval)) < 0) {
-    perror("ftpd: setsockopt SO_REUSEADDR");
+  int loops = server->config.acceptors;
+  bool shared = loops > 1;
+  if (handoff.listener_count > 0) {
+    /* Every listener taken over keeps a loop; more may join only
+       listeners that share the port */
+    if (loops < handoff.listener_count || !handoff.shared) {
+      loops = handoff.listener_count;
+    }
+    shared = handoff.shared;
+    printf("ftpd: took over %d listening sockets\n",
+           handoff.listener_count);
   }
 
-  /* Bind to port */
-  struct sockaddr_in server_addr = {
-    .sin_family = AF_INET,
-    .sin_addr.s_addr = htonl(INADDR_ANY),
-    .sin_port = htons(server->config.port)
-  };
+  /* Share the clients out among the loops, each with its listener */
+  int max_clients = server->config.max_clients;
+  if (loops > max_clients) {
+    loops = max_clients;
+  }
+  for (int i = 0; i < loops; i++) {
+    ftpd_loop_t *loop = &server->loops[server->loop_count++];
+    int share = max_clients / loops + (i < max_clients % loops);
+    int listen_fd = i < handoff.listener_count ? handoff.listeners[i] : -1;
+    if (open_loop(server, loop, share, listen_fd, shared) < 0) {
+      return -1;
+    }
+  }
+  choose_cpus(server);
 
-  if (bind(server->listen_fd, (struct sockaddr *)&server_addr,
-           sizeof(server_addr)) < 0) {
-    perror("ftpd: bind");
-    close(server->listen_fd);
-    server->listen_fd = -1;
+  ftpd_stats_attach(server->stats);
+  if (start_workers(server) < 0) {
     return -1;
   }
-
-  /* Start listening */
-  int max_clients = server->config.max_clients;
-  if (max_clients <= 0) {
-    max_clients = FTPD_MAX_CLIENTS;
+  if (server->config.stats_port &&
+      ftpd_stats_start(server, handoff.stats_fd) < 0) {
+    return -1;
+  }
+  if (!server->config.stats_port && handoff.stats_fd >= 0) {
+    close(handoff.stats_fd);
   }
 
-  if (listen(server->listen_fd, max_clients) < 0) {
-    perror("ftpd: listen");
-    close(server->listen_fd);
-    server->listen_fd = -1;
-    return -1;
+  /* Offer the listeners to the next server */
+  if (server->config.handoff_path) {
+    server->handoff_fd = ftpd_handoff_listen(server);
+    struct epoll_event ev = { .events = EPOLLIN,
+                              .data.ptr = &server->handoff_fd };
+    if (server->handoff_fd < 0 ||
+        epoll_ctl(server->loops[0].epoll_fd, EPOLL_CTL_ADD,
+                  server->handoff_fd, &ev) < 0) {
+      return -1;
+    }
   }
 
+  /* Bind passive listeners now, so PASV costs no socket setup */
+  ftpd_data_pool_fill(server);
+
   printf("ftpd: listening on port %d\n", server->config.port);
+  if (server->loop_count > 1) {
+    printf("ftpd: accepting on %d event loops\n", server->loop_count);
+  }
   printf("ftpd: serving files from %s\n", server->root_realpath);
 
   server->running = true;
-
-  /* Accept loop */
-  while (server->running) {
-    if (accept_client(server) < 0) {
-      /* Fatal error in accept */
-      break;
-    }
+  if (start_loops(server) < 0) {
+    wake_loops(server);
+    return -1;
   }
 
+  /* Running: the old server may stop accepting */
+  ftpd_handoff_done(&handoff);
+
+  /* The first loop runs here, once the other threads have started */
+  pin_loop(&server->loops[0]);
+  run_loop(&server->loops[0]);
+
   return 0;
 }
 
@@ -247,11 +1117,17 @@ void ftpd_stop(ftpd_server_t *server) {
 
   server->running = false;
 
-  /* Close listening socket to interrupt accept() */
-  if (server->listen_fd >= 0) {
-    shutdown(server->listen_fd, SHUT_RDWR);
-    close(server->listen_fd);
-    server->listen_fd = -1;
+  /* Close the listening sockets and wake the event loops */
+  for (int i = 0; i < server->loop_count; i++) {
+    ftpd_loop_t *loop = &server->loops[i];
+    if (loop->listen_fd >= 0) {
+      shutdown(loop->listen_fd, SHUT_RDWR);
+      close(loop->listen_fd);
+      loop->listen_fd = -1;
+    }
+    if (loop->wake_fd >= 0) {
+      eventfd_write(loop->wake_fd, 1);
+    }
   }
 }
 
@@ -261,32 +1137,96 @@ void ftpd_cleanup(ftpd_server_t *server) {
     return;
   }
 
-  /* Close listening socket if still open */
-  if (server->listen_fd >= 0) {
-    close(server->listen_fd);
-    server->listen_fd = -1;
+  /* The other loops stop with the first; close listening sockets if
+     still open */
+  for (int i = 0; i < server->loop_count; i++) {
+    ftpd_loop_t *loop = &server->loops[i];
+    if (loop->started) {
+      pthread_join(loop->thread, NULL);
+      loop->started = false;
+    }
+    if (loop->listen_fd >= 0) {
+      close(loop->listen_fd);
+      loop->listen_fd = -1;
+    }
   }
 
-  /* Close all client connections */
-  pthread_mutex_lock(&server->clients_lock);
-  ftpd_client_t *client = server->clients;
-  while (client) {
-    ftpd_client_t *next = client->next;
-    /* Close client socket to interrupt any blocking operations */
-    if (client->ctrl_fd >= 0) {
-      shutdown(client->ctrl_fd, SHUT_RDWR);
-      close(client->ctrl_fd);
-      client->ctrl_fd = -1;
+  ftpd_stats_stop(server);
+
+  /* Unless handed over, the path is still this server's */
+  if (server->handoff_conn >= 0) {
+    close(server->handoff_conn);
+    server->handoff_conn = -1;
+  }
+  if (server->handoff_fd >= 0) {
+    close(server->handoff_fd);
+    server->handoff_fd = -1;
+    unlink(server->config.handoff_path);
+  }
+
+  /* Stop the workers, giving running transfers a second to finish */
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += 1;
+
+  pthread_mutex_lock(&server->jobs_lock);
+  server->stopping = true;
+  pthread_cond_broadcast(&server->jobs_cond);
+  while (server->active_jobs > 0 &&
+         pthread_cond_timedwait(&server->jobs_cond, &server->jobs_lock,
+                                &deadline) == 0) {
+  }
+  bool idle = server->active_jobs == 0;
+  pthread_mutex_unlock(&server->jobs_lock);
+
+  if (idle) {
+    for (int i = 0; i < server->worker_count; i++) {
+      pthread_join(server->workers[i], NULL);
     }
-    client = next;
   }
-  pthread_mutex_unlock(&server->clients_lock);
 
-  /* Give threads a moment to exit */
-  usleep(100000);  /* 100ms */
+  /* Close all client connections a worker is not using */
+  for (int i = 0; i < server->loop_count; i++) {
+    ftpd_loop_t *loop = &server->loops[i];
+    for (int j = 0; loop->clients && j < loop->max_clients; j++) {
+      ftpd_client_t *client = loop->clients[j];
+      if (client && (idle || !client->busy)) {
+        disconnect_client(loop, client);
+      }
+    }
+    if (loop->epoll_fd >= 0) {
+      close(loop->epoll_fd);
+      loop->epoll_fd = -1;
+    }
+  }
+  ftpd_data_pool_free(server);
 
-  /* Destroy mutex */
-  pthread_mutex_destroy(&server->clients_lock);
+  /* A worker still transferring keeps the rest until the process exits */
+  if (idle) {
+    for (int i = 0; i < server->loop_count; i++) {
+      ftpd_loop_t *loop = &server->loops[i];
+      if (loop->wake_fd >= 0) {
+        close(loop->wake_fd);
+        loop->wake_fd = -1;
+      }
+      free(loop->clients);
+      free(loop->free_slots);
+      loop->clients = NULL;
+      loop->free_slots = NULL;
+    }
+    pthread_cond_destroy(&server->jobs_cond);
+    pthread_mutex_destroy(&server->jobs_lock);
+    ftpd_bucket_destroy(&server->total_rate);
+    ftpd_stats_destroy(server->stats);
+    server->stats = NULL;
+    ftpd_cache_destroy(&server->cache);
+    ftpd_tls_free(server);
+    pthread_mutex_destroy(&server->pasv_lock);
+    if (server->root_fd >= 0) {
+      close(server->root_fd);
+      server->root_fd = -1;
+    }
+  }
 
   printf("ftpd: server stopped\n");
 }
@@ -10,18 +10,45 @@
 #define FTPD_H
 
 #include <stdint.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <pthread.h>
 #include <limits.h>
+#include <sys/types.h>
+
+#include "ftpd_cache.h"
+#include "ftpd_rate.h"
 
 /** Default port for the FTP server. */
 #define FTPD_DEFAULT_PORT 21021
 
 /** Maximum number of simultaneous client connections. */
-#define FTPD_MAX_CLIENTS 64
+#define FTPD_MAX_CLIENTS 4096
+
+/** Default number of data transfers at once, one per worker thread. */
+#define FTPD_WORKERS 8
+
+/** Most data transfers at once that may be configured. */
+#define FTPD_MAX_WORKERS 64
+
+/** Most event loops, each accepting connections, that may be configured. */
+#define FTPD_MAX_ACCEPTORS 64
+
+/** Default size up to which a download goes ahead of bulk transfers. */
+#define FTPD_SMALL_FILE (1024 * 1024)
+
+/** Default bytes of small files kept in memory for downloads. */
+#define FTPD_CACHE_SIZE (64 * 1024 * 1024)
 
-/** Size of read/write buffers for data transfers. */
-#define FTPD_BUFFER_SIZE 4096
+/** Default seconds a replaced server serves its sessions before ending
+    them. */
+#define FTPD_DRAIN_TIMEOUT 300
+
+/** Size of the buffer for transfers the kernel cannot splice. */
+#define FTPD_BUFFER_SIZE (256 * 1024)
+
+/** Size of the buffer a directory listing is sent from. */
+#define FTPD_LIST_BUFFER (64 * 1024)
 
 /** Maximum length of an FTP command line. */
 #define FTPD_CMD_MAX 512
@@ -29,6 +56,21 @@
 /** Maximum length of a username. */
 #define FTPD_USERNAME_MAX 64
 
+/** Passive data listeners kept bound and listening between transfers. */
+#define FTPD_PASV_POOL 16
+
+/** How long to wait for a client's passive data connection, in ms. */
+#define FTPD_DATA_TIMEOUT_MS 30000
+
+/** Deflate level of MODE Z until OPTS MODE Z LEVEL changes it. */
+#define FTPD_ZLIB_LEVEL 6
+
+/** Size from which a MODE Z download is deflated on several threads. */
+#define FTPD_ZLIB_PARALLEL (4 * 1024 * 1024)
+
+/** Threads deflating one MODE Z download. */
+#define FTPD_ZLIB_THREADS 4
+
 
 /**
  * @brief Server configuration structure.
@@ -39,41 +81,173 @@ typedef struct ftpd_config {
   uint16_t port;          /**< Port to listen on. */
   const char *root_dir;   /**< Root directory for FTP files. */
   int max_clients;        /**< Maximum simultaneous clients. */
+  uint16_t pasv_min_port; /**< Lowest passive data port; 0 for any. */
+  uint16_t pasv_max_port; /**< Highest passive data port. */
+  const char *pasv_address; /**< IPv4 address in PASV replies, or NULL. */
+  uint64_t rate_limit;    /**< Bytes per second per client; 0 for none. */
+  uint64_t total_rate_limit; /**< Bytes per second in all; 0 for none. */
+  int max_transfers;      /**< Data transfers at once; 0 for default. */
+  off_t small_file;       /**< Largest download counted as small; 0 for
+                               default, -1 for none. */
+  off_t cache_size;       /**< Bytes of small files kept in memory, the
+                               largest small_file bytes each; 0 for
+                               default, -1 for none. */
+  uint16_t stats_port;    /**< Loopback port of the stats endpoint; 0 for
+                               none. */
+  const char *tls_cert;   /**< PEM certificate chain for AUTH TLS, or
+                               NULL for no TLS. */
+  const char *tls_key;    /**< PEM private key; NULL if in tls_cert. */
+  bool fsync_uploads;     /**< Whether an upload is flushed to disk
+                               before it is reported complete. */
+  bool digest_uploads;    /**< Whether an upload is digested as it
+                               arrives, for HASH, XSHA256 and XCRC. */
+  int acceptors;          /**< Event loops, each with a listener of its
+                               own; 0 for one. */
+  const char *handoff_path; /**< Unix socket to take the listeners of a
+                               running server from and offer them on, or
+                               NULL; see ftpd_handoff.h. */
+  int drain_timeout;      /**< Seconds a replaced server serves its
+                               sessions; 0 for default. */
 } ftpd_config_t;
 
 
 /**
  * @brief Client session state.
  *
- * Represents a connected FTP client with all associated state.
+ * Represents a connected FTP client with all associated state. Its
+ * event loop owns it, except while busy, when a worker runs its
+ * transfer command and nothing else touches it.
  */
 typedef struct ftpd_client {
   int ctrl_fd;                      /**< Control connection socket. */
   int data_fd;                      /**< Active data connection socket. */
   uint32_t data_addr;               /**< Client data IP (network order). */
   uint16_t data_port;               /**< Client data port (host order). */
+  int pasv_fd;                      /**< Passive data listener, or -1. */
+  uint16_t pasv_port;               /**< Port of pasv_fd (host order). */
   char username[FTPD_USERNAME_MAX]; /**< Authenticated username. */
-  char cwd[PATH_MAX];               /**< Current working directory. */
+  char cwd[PATH_MAX];               /**< Current directory below the root;
+                                         "/" is the root. */
+  int cwd_fd;                       /**< Descriptor of cwd, or -1 at the
+                                         root. */
   bool authenticated;               /**< Whether USER command succeeded. */
-  bool data_port_set;               /**< Whether PORT command was received. */
-  pthread_t thread;                 /**< Client handler thread. */
+  bool data_port_set;               /**< Whether PORT or PASV was received. */
+  off_t rest_offset;                /**< REST offset for the next transfer. */
+  off_t alloc_size;                 /**< ALLO size for the next upload. */
+  struct ssl_st *ctrl_tls;          /**< TLS of the control connection after
+                                         AUTH TLS, or NULL. */
+  struct ssl_st *data_tls;          /**< TLS of the data connection, or
+                                         NULL. */
+  bool pbsz_set;                    /**< Whether PBSZ was received. */
+  bool prot_private;                /**< Whether PROT P protects data. */
+  bool mode_z;                      /**< Whether MODE Z deflates data. */
+  int z_level;                      /**< Deflate level of MODE Z. */
+  struct jbox_gzip_writer *data_z;  /**< Deflates what ftpd_data_send()
+                                         sends in MODE Z, or NULL. */
+  char inbuf[FTPD_CMD_MAX];         /**< Control input not yet dispatched. */
+  size_t inlen;                     /**< Bytes in inbuf. */
+  char job[FTPD_CMD_MAX];           /**< Transfer command for a worker. */
+  int job_result;                   /**< Handler result of the job. */
+  bool busy;                        /**< Whether a worker owns the client. */
+  bool bulk;                        /**< Whether the job is a bulk one. */
+  uint32_t peer_addr;               /**< Control peer IP (network order). */
+  uint64_t queued_at;               /**< When the job was queued, in us. */
+  ftpd_bucket_t rate;               /**< Limits the client's transfers. */
   struct ftpd_server *server;       /**< Back-pointer to server. */
-  struct ftpd_client *next;         /**< Next client in linked list. */
+  struct ftpd_loop *loop;           /**< Event loop that owns the client. */
+  int slot;                         /**< Index in the loop's client table. */
+  struct ftpd_client *next_job;     /**< Next client in a job queue. */
 } ftpd_client_t;
 
 
+/**
+ * @brief An event loop and the clients it serves.
+ *
+ * Each loop has a listener of its own, bound to the server's port with
+ * SO_REUSEPORT when there are several, so the kernel spreads new
+ * connections over the loops and no accept is shared. A loop's client
+ * table, slots and count are touched by its thread alone.
+ */
+typedef struct ftpd_loop {
+  int listen_fd;                /**< Listening socket. */
+  int epoll_fd;                 /**< epoll on listening and control sockets. */
+  int wake_fd;                  /**< eventfd for workers and ftpd_stop(). */
+  ftpd_client_t **clients;      /**< Client table, max_clients slots;
+                                     NULL marks a free one. */
+  int *free_slots;              /**< Stack of free slots of clients. */
+  int free_count;               /**< Slots on free_slots. */
+  int max_clients;              /**< The loop's share of max_clients. */
+  atomic_int client_count;      /**< Number of connected clients. */
+  ftpd_client_t *done;          /**< Clients whose job has finished;
+                                     guarded by the server's jobs_lock. */
+  int cpu;                      /**< CPU the loop is pinned to, or -1. */
+  pthread_t thread;             /**< Thread of the loop; the first loop
+                                     runs on the caller of ftpd_start(). */
+  bool started;                 /**< Whether thread was started. */
+  struct ftpd_server *server;   /**< Back-pointer to server. */
+} ftpd_loop_t;
+
+
 /**
  * @brief FTP server state.
  *
- * Main server structure containing all server state and client list.
+ * Main server structure containing all server state and the event
+ * loops. A loop waits on its control connections with epoll and runs
+ * their commands, which are quick, itself; commands that open a data
+ * connection go to a small pool of workers, shared by the loops, so an
+ * idle session costs a socket and its client structure rather than a
+ * thread. With several loops, each runs on a thread pinned to a CPU of
+ * its own.
+ *
+ * Transfers wait in two queues. Listings and downloads of small files
+ * are quick and go first. Uploads and large downloads are bulk: they
+ * may hold all workers but a quarter, kept for the quick ones, and the
+ * next bulk job is the oldest from the address with the fewest bulk
+ * transfers running, so one host opening many sessions does not shut
+ * out the others. Token buckets limit each client's rate and the total.
+ *
+ * A server handing its listeners to a new one drains: its loops stop
+ * accepting and each ends once its clients have gone, or at the drain
+ * deadline, when the idle ones are told to reconnect.
  */
 typedef struct ftpd_server {
-  int listen_fd;                /**< Listening socket. */
+  ftpd_loop_t loops[FTPD_MAX_ACCEPTORS]; /**< Event loops. */
+  int loop_count;               /**< Loops set up. */
   ftpd_config_t config;         /**< Server configuration. */
-  ftpd_client_t *clients;       /**< Linked list of connected clients. */
-  pthread_mutex_t clients_lock; /**< Mutex for client list access. */
   volatile bool running;        /**< Server running flag. */
   char root_realpath[PATH_MAX]; /**< Resolved absolute root path. */
+  int root_fd;                  /**< O_PATH descriptor of the root. */
+  pthread_t workers[FTPD_MAX_WORKERS]; /**< Transfer worker threads. */
+  int worker_count;             /**< Number of workers started. */
+  pthread_mutex_t jobs_lock;    /**< Mutex for the job queues. */
+  pthread_cond_t jobs_cond;     /**< Signalled when jobs change. */
+  ftpd_client_t *jobs;          /**< Quick jobs waiting for a worker. */
+  ftpd_client_t *jobs_tail;     /**< Last client in jobs. */
+  ftpd_client_t *bulk_jobs;     /**< Bulk jobs waiting for a worker. */
+  ftpd_client_t *bulk_tail;     /**< Last client in bulk_jobs. */
+  int bulk_limit;               /**< Bulk jobs that may run at once. */
+  int bulk_running;             /**< Bulk jobs running. */
+  uint32_t bulk_peers[FTPD_MAX_WORKERS]; /**< Peers of those jobs. */
+  ftpd_bucket_t total_rate;     /**< Limits all transfers together. */
+  int active_jobs;              /**< Jobs queued or running. */
+  bool stopping;                /**< Tells workers to exit. */
+  uint32_t pasv_addr;           /**< config.pasv_address (network order). */
+  pthread_mutex_t pasv_lock;    /**< Mutex for the passive listener pool. */
+  int pasv_pool[FTPD_PASV_POOL]; /**< Idle passive listeners. */
+  uint16_t pasv_ports[FTPD_PASV_POOL]; /**< Ports of pasv_pool. */
+  int pasv_count;               /**< Listeners in pasv_pool. */
+  unsigned int pasv_next;       /**< Next port of the range to try. */
+  struct ftpd_stats *stats;     /**< Counters; see ftpd_stats.h. */
+  ftpd_cache_t cache;           /**< Small files being downloaded. */
+  struct ssl_ctx_st *tls_ctx;   /**< TLS context, or NULL without TLS;
+                                     see ftpd_tls.h. */
+  int handoff_fd;               /**< Socket a new server takes the
+                                     listeners from, or -1. */
+  int handoff_conn;             /**< New server sent the listeners and not
+                                     yet running, or -1. */
+  atomic_bool draining;         /**< Whether the listeners were handed
+                                     over and the loops are draining. */
+  uint64_t drain_until;         /**< When draining ends, in us. */
 } ftpd_server_t;
 
 
@@ -93,8 +267,11 @@ int ftpd_init(ftpd_server_t *server, const ftpd_config_t *config);
 /**
  * @brief Start the FTP server.
  *
- * Creates the listening socket and enters the accept loop.
- * This function blocks until ftpd_stop() is called.
+ * Creates the listening sockets, or takes them over from the server at
+ * config.handoff_path, starts the transfer workers and the other event
+ * loops, and runs the first loop. This function blocks until
+ * ftpd_stop() is called, a loop fails, or the loops have drained after
+ * handing the listeners on.
  *
  * @param server Pointer to initialized server.
  * @return 0 on normal shutdown, -1 on error.
@@ -105,8 +282,8 @@ int ftpd_start(ftpd_server_t *server);
 /**
  * @brief Signal the server to stop.
  *
- * Sets the running flag to false and closes the listening socket
- * to interrupt the accept loop. Safe to call from signal handlers.
+ * Sets the running flag to false, closes the listening sockets and
+ * wakes the event loops. Safe to call from signal handlers.
  *
  * @param server Pointer to running server.
  */
@@ -116,7 +293,9 @@ void ftpd_stop(ftpd_server_t *server);
 /**
  * @brief Clean up server resources.
  *
- * Waits for all client threads to finish and frees resources.
+ * Waits for the event loops, stops the workers, giving running
+ * transfers a moment to finish,
+ * closes all client connections and frees resources.
  * Should be called after ftpd_start() returns.
  *
  * @param server Pointer to server to clean up.
@@ -0,0 +1,258 @@
+/**
+ * @file ftpd_cache.c
+ * @brief Small files kept in memory for the downloads of all clients.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ftpd_cache.h"
+
+
+/**
+ * @brief Hash chain of a file.
+ *
+ * @param dev Device.
+ * @param ino Inode.
+ * @return Index in the buckets.
+ */
+static size_t bucket_of(dev_t dev, ino_t ino) {
+  uint64_t h = (uint64_t)ino * 0x9e3779b97f4a7c15ULL ^ (uint64_t)dev;
+  return (size_t)(h >> 32) % FTPD_CACHE_BUCKETS;
+}
+
+
+/**
+ * @brief Whether an entry holds a file as it is now.
+ *
+ * @param entry Entry.
+ * @param st Status of the file.
+ * @return true if size and times are those the entry was read at.
+ */
+static bool matches(const ftpd_cache_entry_t *entry, const struct stat *st) {
+  return entry->size == st->st_size &&
+         entry->mtime.tv_sec == st->st_mtim.tv_sec &&
+         entry->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+         entry->ctime.tv_sec == st->st_ctim.tv_sec &&
+         entry->ctime.tv_nsec == st->st_ctim.tv_nsec;
+}
+
+
+/**
+ * @brief Take an entry out of the recently used list.
+ *
+ * @param cache Cache, locked.
+ * @param entry Entry in the list.
+ */
+static void unlink_used(ftpd_cache_t *cache, ftpd_cache_entry_t *entry) {
+  if (entry->newer) {
+    entry->newer->older = entry->older;
+  } else {
+    cache->newest = entry->older;
+  }
+  if (entry->older) {
+    entry->older->newer = entry->newer;
+  } else {
+    cache->oldest = entry->newer;
+  }
+  entry->newer = entry->older = NULL;
+}
+
+
+/**
+ * @brief Put an entry at the recent end of the used list.
+ *
+ * @param cache Cache, locked.
+ * @param entry Entry not in the list.
+ */
+static void push_newest(ftpd_cache_t *cache, ftpd_cache_entry_t *entry) {
+  entry->older = cache->newest;
+  entry->newer = NULL;
+  if (cache->newest) {
+    cache->newest->newer = entry;
+  } else {
+    cache->oldest = entry;
+  }
+  cache->newest = entry;
+}
+
+
+/**
+ * @brief Drop a reference to an entry, freeing it with the last one.
+ *
+ * @param entry Entry.
+ */
+static void drop_ref(ftpd_cache_entry_t *entry) {
+  if (--entry->refs == 0) {
+    free(entry->data);
+    free(entry);
+  }
+}
+
+
+/**
+ * @brief Take an entry out of the cache; downloads holding it keep it.
+ *
+ * @param cache Cache, locked.
+ * @param entry Listed entry.
+ */
+static void unlist(ftpd_cache_t *cache, ftpd_cache_entry_t *entry) {
+  ftpd_cache_entry_t **link = &cache->buckets[bucket_of(entry->dev,
+                                                        entry->ino)];
+  while (*link != entry) {
+    link = &(*link)->next;
+  }
+  *link = entry->next;
+  entry->next = NULL;
+
+  unlink_used(cache, entry);
+  cache->bytes -= (size_t)entry->size;
+  drop_ref(entry);
+}
+
+
+/**
+ * @brief Read a whole file into an entry.
+ *
+ * @param entry Entry with size set and data allocated.
+ * @param fd File.
+ * @return 0 on success, -1 if reading failed or the file changed
+ *         meanwhile.
+ */
+static int read_entry(ftpd_cache_entry_t *entry, int fd) {
+  off_t pos = 0;
+  while (pos < entry->size) {
+    ssize_t n = pread(fd, entry->data + pos, (size_t)(entry->size - pos),
+                      pos);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    pos += n;
+  }
+
+  /* A write during the read may have left a mix of old and new */
+  struct stat st;
+  return fstat(fd, &st) == 0 && matches(entry, &st) ? 0 : -1;
+}
+
+
+void ftpd_cache_init(ftpd_cache_t *cache, size_t capacity, off_t file_max) {
+  memset(cache, 0, sizeof(*cache));
+  pthread_mutex_init(&cache->lock, NULL);
+  pthread_cond_init(&cache->loaded, NULL);
+  cache->capacity = capacity;
+  cache->file_max = (size_t)file_max > capacity ? (off_t)capacity
+                                                : file_max;
+}
+
+
+void ftpd_cache_destroy(ftpd_cache_t *cache) {
+  while (cache->oldest) {
+    unlist(cache, cache->oldest);
+  }
+  pthread_cond_destroy(&cache->loaded);
+  pthread_mutex_destroy(&cache->lock);
+}
+
+
+const ftpd_cache_entry_t *ftpd_cache_get(ftpd_cache_t *cache, int fd,
+                                         const struct stat *st, bool *hit) {
+  *hit = false;
+  if (cache->capacity == 0 || !S_ISREG(st->st_mode) || st->st_size <= 0 ||
+      st->st_size > cache->file_max) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  ftpd_cache_entry_t *entry = cache->buckets[bucket_of(st->st_dev,
+                                                       st->st_ino)];
+  while (entry && (entry->dev != st->st_dev || entry->ino != st->st_ino)) {
+    entry = entry->next;
+  }
+  if (entry && !matches(entry, st)) {
+    unlist(cache, entry);
+    entry = NULL;
+  }
+
+  if (entry) {
+    entry->refs++;
+    unlink_used(cache, entry);
+    push_newest(cache, entry);
+    while (!entry->ready && !entry->failed) {
+      pthread_cond_wait(&cache->loaded, &cache->lock);
+    }
+    if (entry->failed) {
+      drop_ref(entry);
+      entry = NULL;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    *hit = entry != NULL;
+    return entry;
+  }
+
+  /* List the entry before reading it, so others wait for this read */
+  entry = calloc(1, sizeof(*entry));
+  char *data = entry ? malloc((size_t)st->st_size) : NULL;
+  if (!data) {
+    pthread_mutex_unlock(&cache->lock);
+    free(entry);
+    return NULL;
+  }
+  entry->dev = st->st_dev;
+  entry->ino = st->st_ino;
+  entry->size = st->st_size;
+  entry->mtime = st->st_mtim;
+  entry->ctime = st->st_ctim;
+  entry->data = data;
+  entry->refs = 2;
+  size_t b = bucket_of(entry->dev, entry->ino);
+  entry->next = cache->buckets[b];
+  cache->buckets[b] = entry;
+  push_newest(cache, entry);
+  cache->bytes += (size_t)entry->size;
+  while (cache->bytes > cache->capacity && cache->oldest != entry) {
+    unlist(cache, cache->oldest);
+  }
+  pthread_mutex_unlock(&cache->lock);
+
+  int rc = read_entry(entry, fd);
+
+  pthread_mutex_lock(&cache->lock);
+  if (rc == 0) {
+    entry->ready = true;
+  } else {
+    entry->failed = true;
+    /* Unless already evicted or replaced */
+    ftpd_cache_entry_t *listed = cache->buckets[b];
+    while (listed && listed != entry) {
+      listed = listed->next;
+    }
+    if (listed) {
+      unlist(cache, entry);
+    }
+    drop_ref(entry);
+    entry = NULL;
+  }
+  pthread_cond_broadcast(&cache->loaded);
+  pthread_mutex_unlock(&cache->lock);
+  return entry;
+}
+
+
+void ftpd_cache_release(ftpd_cache_t *cache, const ftpd_cache_entry_t *entry) {
+  if (!entry) {
+    return;
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  drop_ref((ftpd_cache_entry_t *)entry);
+  pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,111 @@
+/**
+ * @file ftpd_cache.h
+ * @brief Small files kept in memory for the downloads of all clients.
+ *
+ * When many clients fetch the same few files at once, such as the
+ * current build or a shared data set, each download would read the file
+ * again. A file no larger than the cache's file limit is read once into
+ * memory instead, and every download of it is sent from there while the
+ * file is unchanged. Entries are keyed by device and inode and remember
+ * the size, modification and change times they were read at; a file
+ * that no longer matches is read afresh.
+ *
+ * Entries are reference counted, so one being sent outlives its eviction
+ * or replacement. The least recently used go once the cache holds more
+ * than its capacity. A client asking for a file that another client is
+ * still reading waits for that read rather than starting its own, so a
+ * crowd arriving at once reads the disk once.
+ */
+
+#ifndef FTPD_CACHE_H
+#define FTPD_CACHE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+
+/** Hash chains of a cache. */
+#define FTPD_CACHE_BUCKETS 256
+
+
+/**
+ * @brief A file held in memory.
+ */
+typedef struct ftpd_cache_entry {
+  dev_t dev;                        /**< Device of the file. */
+  ino_t ino;                        /**< Inode of the file. */
+  off_t size;                       /**< Size read; also of data. */
+  struct timespec mtime;            /**< Modification time when read. */
+  struct timespec ctime;            /**< Change time when read. */
+  char *data;                       /**< Contents of the file. */
+  int refs;                         /**< The cache's reference while
+                                         listed, and one per download. */
+  bool ready;                       /**< Whether data has been read. */
+  bool failed;                      /**< Whether reading data failed. */
+  struct ftpd_cache_entry *next;    /**< Next entry in the hash chain. */
+  struct ftpd_cache_entry *newer;   /**< Next more recently used. */
+  struct ftpd_cache_entry *older;   /**< Next less recently used. */
+} ftpd_cache_entry_t;
+
+
+/**
+ * @brief Cache of small files.
+ */
+typedef struct ftpd_cache {
+  pthread_mutex_t lock;             /**< Guards the rest and the entries. */
+  pthread_cond_t loaded;            /**< Signalled when an entry is read. */
+  ftpd_cache_entry_t *buckets[FTPD_CACHE_BUCKETS]; /**< Hash chains. */
+  ftpd_cache_entry_t *newest;       /**< Most recently used entry. */
+  ftpd_cache_entry_t *oldest;       /**< Least recently used entry. */
+  size_t bytes;                     /**< Bytes of the listed entries. */
+  size_t capacity;                  /**< Bytes kept; 0 for no cache. */
+  off_t file_max;                   /**< Largest file kept. */
+} ftpd_cache_t;
+
+
+/**
+ * @brief Initialize an empty cache.
+ *
+ * @param cache Cache to initialize.
+ * @param capacity Bytes of files to keep; 0 to keep none.
+ * @param file_max Largest file to keep.
+ */
+void ftpd_cache_init(ftpd_cache_t *cache, size_t capacity, off_t file_max);
+
+
+/**
+ * @brief Free a cache; no entry may still be held.
+ *
+ * @param cache Cache.
+ */
+void ftpd_cache_destroy(ftpd_cache_t *cache);
+
+
+/**
+ * @brief Get the contents of a file from the cache, reading it in if
+ *        it is small enough and not there yet.
+ *
+ * @param cache Cache.
+ * @param fd File, open for reading; its offset is not used.
+ * @param st Status of fd.
+ * @param hit Set to whether the file was in memory already.
+ * @return Entry to send from, to be released with ftpd_cache_release(),
+ *         or NULL if the file is not cached and is to be read as usual.
+ */
+const ftpd_cache_entry_t *ftpd_cache_get(ftpd_cache_t *cache, int fd,
+                                         const struct stat *st, bool *hit);
+
+
+/**
+ * @brief Release an entry from ftpd_cache_get().
+ *
+ * @param cache Cache.
+ * @param entry Entry.
+ */
+void ftpd_cache_release(ftpd_cache_t *cache, const ftpd_cache_entry_t *entry);
+
+
+#endif /* FTPD_CACHE_H */
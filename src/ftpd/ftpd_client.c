@@ -13,12 +13,21 @@
 #include <unistd.h>
 #include <ctype.h>
 #include <errno.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 
 #include "ftpd.h"
 #include "ftpd_client.h"
 #include "ftpd_commands.h"
 #include "ftpd_data.h"
+#include "ftpd_path.h"
+#include "ftpd_stats.h"
+#include "ftpd_tls.h"
+
+
+/** How long a response may wait for a client to read, in ms. */
+#define FTPD_SEND_TIMEOUT_MS 30000
 
 
 /**
@@ -28,41 +37,72 @@ typedef struct {
   const char *name;
   int (*handler)(ftpd_client_t *client, const char *arg);
   bool requires_auth;
+  bool transfer;          /**< Blocks on a connection; runs on a worker. */
 } ftpd_cmd_entry_t;
 
 
 /** Command dispatch table. */
 static const ftpd_cmd_entry_t cmd_table[] = {
-  {"USER", ftpd_cmd_user, false},
-  {"QUIT", ftpd_cmd_quit, false},
-  {"PORT", ftpd_cmd_port, true},
-  {"STOR", ftpd_cmd_stor, true},
-  {"RETR", ftpd_cmd_retr, true},
-  {"LIST", ftpd_cmd_list, true},
-  {"MKD",  ftpd_cmd_mkd,  true},
-  {"PWD",  ftpd_cmd_pwd,  true},
-  {"CWD",  ftpd_cmd_cwd,  true},
-  {"TYPE", ftpd_cmd_type, true},
-  {"SYST", ftpd_cmd_syst, false},
-  {"NOOP", ftpd_cmd_noop, false},
-  {NULL, NULL, false}
+  {"AUTH", ftpd_cmd_auth, false, true},
+  {"PBSZ", ftpd_cmd_pbsz, false, false},
+  {"PROT", ftpd_cmd_prot, false, false},
+  {"USER", ftpd_cmd_user, false, false},
+  {"QUIT", ftpd_cmd_quit, false, false},
+  {"PORT", ftpd_cmd_port, true,  false},
+  {"PASV", ftpd_cmd_pasv, true,  false},
+  {"EPSV", ftpd_cmd_epsv, true,  false},
+  {"REST", ftpd_cmd_rest, true,  false},
+  {"ALLO", ftpd_cmd_allo, true,  false},
+  {"STOR", ftpd_cmd_stor, true,  true},
+  {"APPE", ftpd_cmd_appe, true,  true},
+  {"RETR", ftpd_cmd_retr, true,  true},
+  {"SIZE", ftpd_cmd_size, true,  false},
+  {"MDTM", ftpd_cmd_mdtm, true,  false},
+  {"HASH", ftpd_cmd_hash, true,  true},
+  {"XSHA256", ftpd_cmd_xsha256, true, true},
+  {"XCRC", ftpd_cmd_xcrc, true,  true},
+  {"LIST", ftpd_cmd_list, true,  true},
+  {"MLSD", ftpd_cmd_mlsd, true,  true},
+  {"MLST", ftpd_cmd_mlst, true,  false},
+  {"FEAT", ftpd_cmd_feat, false, false},
+  {"MKD",  ftpd_cmd_mkd,  true,  false},
+  {"DELE", ftpd_cmd_dele, true,  false},
+  {"RMD",  ftpd_cmd_rmd,  true,  false},
+  {"PWD",  ftpd_cmd_pwd,  true,  false},
+  {"CWD",  ftpd_cmd_cwd,  true,  false},
+  {"TYPE", ftpd_cmd_type, true,  false},
+  {"MODE", ftpd_cmd_mode, true,  false},
+  {"OPTS", ftpd_cmd_opts, false, false},
+  {"SYST", ftpd_cmd_syst, false, false},
+  {"NOOP", ftpd_cmd_noop, false, false},
+  {"SITE", ftpd_cmd_site, true,  false},
+  {NULL, NULL, false, false}
 };
 
 
+const char *ftpd_command_name(int index) {
+  int count = (int)(sizeof(cmd_table) / sizeof(cmd_table[0])) - 1;
+  return index >= 0 && index < count ? cmd_table[index].name : NULL;
+}
+
+
 void ftpd_client_init(ftpd_client_t *client, int ctrl_fd,
                       ftpd_server_t *server) {
   memset(client, 0, sizeof(*client));
   client->ctrl_fd = ctrl_fd;
   client->data_fd = -1;
+  client->pasv_fd = -1;
   client->data_port = 0;
   client->authenticated = false;
   client->data_port_set = false;
+  client->z_level = FTPD_ZLIB_LEVEL;
   client->server = server;
-  client->next = NULL;
 
-  /* Set initial cwd to server root */
-  strncpy(client->cwd, server->root_realpath, sizeof(client->cwd) - 1);
-  client->cwd[sizeof(client->cwd) - 1] = '\0';
+  /* Start at the server root, which needs no descriptor */
+  client->cwd_fd = -1;
+  strcpy(client->cwd, "/");
+
+  ftpd_bucket_init(&client->rate, server->config.rate_limit);
 }
 
 
@@ -75,63 +115,51 @@ void ftpd_client_cleanup(ftpd_client_t *client) {
   ftpd_data_close(client);
 
   /* Close control connection */
+  ftpd_tls_close(client->ctrl_tls, 0);
+  client->ctrl_tls = NULL;
   if (client->ctrl_fd >= 0) {
     close(client->ctrl_fd);
     client->ctrl_fd = -1;
   }
+
+  ftpd_path_chroot(client);
+  ftpd_bucket_destroy(&client->rate);
 }
 
 
-int ftpd_read_command(ftpd_client_t *client, char *buf, size_t bufsize) {
-  if (!client || !buf || bufsize < 2) {
+int ftpd_client_read(ftpd_client_t *client) {
+  if (!client || client->ctrl_fd < 0) {
     return -1;
   }
 
-  size_t pos = 0;
-  while (pos < bufsize - 1) {
-    char c;
-    ssize_t n = recv(client->ctrl_fd, &c, 1, 0);
-
-    if (n < 0) {
-      if (errno == EINTR) {
-        continue;
-      }
-      return -1;
+  /* Read whatever has arrived; a full buffer waits for process() */
+  while (client->inlen < sizeof(client->inbuf)) {
+    char *buf = client->inbuf + client->inlen;
+    size_t room = sizeof(client->inbuf) - client->inlen;
+    ssize_t n = client->ctrl_tls ? ftpd_tls_read(client->ctrl_tls, buf, room)
+                                 : recv(client->ctrl_fd, buf, room, 0);
+    if (n > 0) {
+      client->inlen += (size_t)n;
+      continue;
     }
-
     if (n == 0) {
       /* Connection closed */
-      if (pos > 0) {
-        buf[pos] = '\0';
-        return (int)pos;
-      }
       return 0;
     }
-
-    /* Check for end of line */
-    if (c == '\n') {
-      /* Strip trailing CR if present */
-      if (pos > 0 && buf[pos - 1] == '\r') {
-        pos--;
-      }
-      buf[pos] = '\0';
-      return (int)pos;
+    if (errno == EINTR) {
+      continue;
     }
-
-    buf[pos++] = c;
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      break;
+    }
+    return -1;
   }
 
-  /* Buffer full without finding newline */
-  buf[bufsize - 1] = '\0';
-  return (int)(bufsize - 1);
+  return 1;
 }
 
 
 int ftpd_send_response(ftpd_client_t *client, int code, const char *message) {
-  if (!client || client->ctrl_fd < 0) {
-    return -1;
-  }
-
   char buf[512];
   int len = snprintf(buf, sizeof(buf), "%d %s\r\n", code, message);
 
@@ -139,16 +167,35 @@ int ftpd_send_response(ftpd_client_t *client, int code, const char *message) {
     return -1;
   }
 
-  ssize_t sent = 0;
+  ftpd_stats_reply(client->server->stats, code);
+  return ftpd_send_raw(client, buf, (size_t)len);
+}
+
+
+int ftpd_send_raw(ftpd_client_t *client, const char *data, size_t len) {
+  if (!client || client->ctrl_fd < 0) {
+    return -1;
+  }
+
+  size_t sent = 0;
   while (sent < len) {
-    ssize_t n = send(client->ctrl_fd, buf + sent, (size_t)(len - sent), 0);
+    ssize_t n = client->ctrl_tls
+                ? ftpd_tls_write(client->ctrl_tls, data + sent, len - sent)
+                : send(client->ctrl_fd, data + sent, len - sent, 0);
     if (n < 0) {
       if (errno == EINTR) {
         continue;
       }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        /* The control socket is non-blocking; wait for the client */
+        struct pollfd pfd = { .fd = client->ctrl_fd, .events = POLLOUT };
+        if (poll(&pfd, 1, FTPD_SEND_TIMEOUT_MS) > 0) {
+          continue;
+        }
+      }
       return -1;
     }
-    sent += n;
+    sent += (size_t)n;
   }
 
   return 0;
@@ -166,26 +213,27 @@ int ftpd_send_response_fmt(ftpd_client_t *client, int code,
 }
 
 
-int ftpd_dispatch_command(ftpd_client_t *client, const char *cmdline) {
-  if (!client || !cmdline) {
-    return -1;
-  }
-
+/**
+ * @brief Look up the command of a command line.
+ *
+ * @param cmdline Full command line (command + arguments).
+ * @param cmd Buffer receiving the command name, upper-cased.
+ * @param cmdsize Size of cmd.
+ * @param arg Set to the argument, or NULL if there is none.
+ * @return Table entry, or NULL for an empty or unknown command.
+ */
+static const ftpd_cmd_entry_t *find_command(const char *cmdline, char *cmd,
+                                            size_t cmdsize,
+                                            const char **arg) {
   /* Skip leading whitespace */
   while (*cmdline && isspace((unsigned char)*cmdline)) {
     cmdline++;
   }
 
-  /* Empty command */
-  if (*cmdline == '\0') {
-    return 0;
-  }
-
   /* Extract command name */
-  char cmd[16];
   const char *p = cmdline;
   int i = 0;
-  while (*p && !isspace((unsigned char)*p) && i < (int)sizeof(cmd) - 1) {
+  while (*p && !isspace((unsigned char)*p) && i < (int)cmdsize - 1) {
     cmd[i++] = (char)toupper((unsigned char)*p);
     p++;
   }
@@ -195,62 +243,119 @@ int ftpd_dispatch_command(ftpd_client_t *client, const char *cmdline) {
   while (*p && isspace((unsigned char)*p)) {
     p++;
   }
-  const char *arg = (*p) ? p : NULL;
+  *arg = (*p) ? p : NULL;
 
-  /* Look up command */
   for (const ftpd_cmd_entry_t *entry = cmd_table; entry->name; entry++) {
     if (strcmp(cmd, entry->name) == 0) {
-      /* Check authentication */
-      if (entry->requires_auth && !client->authenticated) {
-        ftpd_send_response(client, 530, "Not logged in.");
-        return 0;
-      }
-      return entry->handler(client, arg);
+      return entry;
     }
   }
+  return NULL;
+}
+
+
+int ftpd_dispatch_command(ftpd_client_t *client, const char *cmdline) {
+  if (!client || !cmdline) {
+    return -1;
+  }
+
+  char cmd[16];
+  const char *arg;
+  const ftpd_cmd_entry_t *entry = find_command(cmdline, cmd, sizeof(cmd),
+                                               &arg);
+
+  /* Empty command */
+  if (cmd[0] == '\0') {
+    return 0;
+  }
 
   /* Unknown command */
-  ftpd_send_response_fmt(client, 500, "Unknown command: %s", cmd);
-  return 0;
+  if (!entry) {
+    ftpd_send_response_fmt(client, 500, "Unknown command: %s", cmd);
+    return 0;
+  }
+
+  /* Check authentication */
+  if (entry->requires_auth && !client->authenticated) {
+    ftpd_send_response(client, 530, "Not logged in.");
+    return 0;
+  }
+
+  uint64_t start = ftpd_stats_now();
+  int rc = entry->handler(client, arg);
+  ftpd_stats_command(client->server->stats, (int)(entry - cmd_table),
+                     ftpd_stats_now() - start);
+  return rc;
 }
 
 
-void *ftpd_client_handler(void *arg) {
-  ftpd_client_t *client = (ftpd_client_t *)arg;
+bool ftpd_client_job_is_bulk(ftpd_client_t *client) {
+  char cmd[16];
+  const char *arg;
+  find_command(client->job, cmd, sizeof(cmd), &arg);
 
-  /* Send welcome message */
-  ftpd_send_response(client, 220, "jbox FTP server ready.");
+  if (strcmp(cmd, "STOR") == 0 || strcmp(cmd, "APPE") == 0) {
+    return true;
+  }
+  if (strcmp(cmd, "RETR") != 0 || !arg) {
+    return false;
+  }
 
-  /* Command loop */
-  char cmdbuf[FTPD_CMD_MAX];
-  while (client->server->running) {
-    int len = ftpd_read_command(client, cmdbuf, sizeof(cmdbuf));
+  /* A download is small if what is left of the file after REST is */
+  off_t limit = client->server->config.small_file;
+  struct stat st;
+  return ftpd_path_stat(client, arg, &st) == 0 &&
+         (limit < 0 || st.st_size - client->rest_offset > limit);
+}
 
-    if (len < 0) {
-      /* Error reading */
-      break;
-    }
 
-    if (len == 0) {
-      /* Connection closed */
+int ftpd_client_process(ftpd_client_t *client, bool eof) {
+  /* Lines are terminated in place and the rest moved down once at the end */
+  size_t start = 0;
+  int rc = 0;
+  while (rc == 0 && start < client->inlen) {
+    char *line = client->inbuf + start;
+    size_t avail = client->inlen - start;
+    char *nl = memchr(line, '\n', avail);
+    char whole[FTPD_CMD_MAX];
+    size_t len;
+    if (nl) {
+      len = (size_t)(nl - line);
+      start += len + 1;
+      /* Strip trailing CR if present */
+      if (len > 0 && line[len - 1] == '\r') {
+        len--;
+      }
+    } else if (avail == sizeof(client->inbuf)) {
+      /* A full buffer without LF is a line; it has no room for the NUL */
+      len = avail - 1;
+      memcpy(whole, line, len);
+      line = whole;
+      start += len;
+    } else if (eof) {
+      len = avail;
+      start += len;
+    } else {
       break;
     }
-
-    /* Dispatch command */
-    if (ftpd_dispatch_command(client, cmdbuf) < 0) {
+    line[len] = '\0';
+
+    /* Transfers and handshakes block; leave them to a worker */
+    char cmd[16];
+    const char *arg;
+    const ftpd_cmd_entry_t *entry = find_command(line, cmd, sizeof(cmd),
+                                                 &arg);
+    if (entry && entry->transfer &&
+        (client->authenticated || !entry->requires_auth)) {
+      memcpy(client->job, line, len + 1);
+      rc = 1;
+    } else if (ftpd_dispatch_command(client, line) < 0) {
       /* Handler signaled disconnect */
-      break;
+      rc = -1;
     }
   }
 
-  /* Clean up */
-  ftpd_client_cleanup(client);
-
-  if (client->username[0]) {
-    printf("ftpd: client %s disconnected\n", client->username);
-  } else {
-    printf("ftpd: client disconnected\n");
-  }
-
-  return NULL;
+  client->inlen -= start;
+  memmove(client->inbuf, client->inbuf + start, client->inlen);
+  return rc;
 }
@@ -14,30 +14,46 @@
 
 
 /**
- * @brief Client handler thread entry point.
+ * @brief Read what has arrived on the control connection.
  *
- * Main function for handling a single client connection.
- * Runs in its own thread and processes commands until
- * the client disconnects or QUIT is received.
+ * Appends to the client's input buffer without blocking, until the
+ * socket has nothing more or the buffer is full.
  *
- * @param arg Pointer to ftpd_client_t structure.
- * @return NULL always.
+ * @param client Pointer to client structure.
+ * @return 1 if the connection is open, 0 if the client closed it,
+ *         -1 on error.
  */
-void *ftpd_client_handler(void *arg);
+int ftpd_client_read(ftpd_client_t *client);
 
 
 /**
- * @brief Read a command line from the control connection.
+ * @brief Dispatch the complete command lines in the input buffer.
  *
- * Reads characters until CRLF is encountered or buffer is full.
- * The CRLF is stripped from the returned string.
+ * Lines end in LF, with a CR before it stripped; a line filling the
+ * buffer is taken as it is. Stops at a command that blocks, one that
+ * transfers data or AUTH, which is copied to client->job for a worker
+ * to dispatch, so that the lines after it wait until it is done.
  *
  * @param client Pointer to client structure.
- * @param buf Buffer to store the command.
- * @param bufsize Size of the buffer.
- * @return Number of bytes read, 0 on connection closed, -1 on error.
+ * @param eof Whether the client has closed the connection, so that a
+ *        last line without LF is dispatched too.
+ * @return 0 when the buffer holds no complete line, 1 if a command
+ *         is waiting in client->job, -1 to disconnect the client.
+ */
+int ftpd_client_process(ftpd_client_t *client, bool eof);
+
+
+/**
+ * @brief Whether the transfer in client->job is a bulk one.
+ *
+ * Uploads are, since their size is unknown, and so are downloads of
+ * more than config.small_file bytes. Listings and small downloads are
+ * quick.
+ *
+ * @param client Pointer to client with a job.
+ * @return true for a bulk transfer.
  */
-int ftpd_read_command(ftpd_client_t *client, char *buf, size_t bufsize);
+bool ftpd_client_job_is_bulk(ftpd_client_t *client);
 
 
 /**
@@ -54,6 +70,20 @@ int ftpd_read_command(ftpd_client_t *client, char *buf, size_t bufsize);
 int ftpd_send_response(ftpd_client_t *client, int code, const char *message);
 
 
+/**
+ * @brief Send text to the client as it is.
+ *
+ * For multi-line responses, which the caller formats in full, CRLFs
+ * included.
+ *
+ * @param client Pointer to client structure.
+ * @param data Text to send.
+ * @param len Length of data.
+ * @return 0 on success, -1 on error.
+ */
+int ftpd_send_raw(ftpd_client_t *client, const char *data, size_t len);
+
+
 /**
  * @brief Send a formatted response to the client.
  *
@@ -82,6 +112,15 @@ int ftpd_send_response_fmt(ftpd_client_t *client, int code,
 int ftpd_dispatch_command(ftpd_client_t *client, const char *cmdline);
 
 
+/**
+ * @brief Name of a command in the dispatch table.
+ *
+ * @param index Index in the table, from 0.
+ * @return Command name, or NULL past the end of the table.
+ */
+const char *ftpd_command_name(int index);
+
+
 /**
  * @brief Initialize a new client structure.
  *
@@ -3,17 +3,25 @@
  * @brief FTP command handler implementations.
  *
  * This module implements all FTP command handlers including
- * USER, QUIT, PORT, STOR, RETR, LIST, MKD, PWD, CWD, TYPE, SYST, and NOOP.
+ * AUTH, PBSZ, PROT, USER, QUIT, PORT, STOR, RETR, LIST, MLSD, MKD, PWD,
+ * CWD, TYPE, SYST, NOOP and SITE.
  */
 
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <ctype.h>
 #include <dirent.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <pwd.h>
 #include <grp.h>
 #include <time.h>
@@ -22,7 +30,95 @@
 #include "ftpd_commands.h"
 #include "ftpd_client.h"
 #include "ftpd_data.h"
+#include "ftpd_digest.h"
 #include "ftpd_path.h"
+#include "ftpd_stats.h"
+#include "ftpd_tls.h"
+
+
+int ftpd_cmd_auth(ftpd_client_t *client, const char *arg) {
+  if (!client->server->tls_ctx) {
+    ftpd_send_response(client, 502, "TLS is not configured.");
+    return 0;
+  }
+  if (!arg || (strcasecmp(arg, "TLS") != 0 && strcasecmp(arg, "TLS-C") != 0 &&
+               strcasecmp(arg, "SSL") != 0)) {
+    ftpd_send_response(client, 504, "Unknown security mechanism.");
+    return 0;
+  }
+  if (client->ctrl_tls) {
+    ftpd_send_response(client, 503, "Already using TLS.");
+    return 0;
+  }
+
+  /* Anything sent in the clear behind AUTH would pass for protected */
+  client->inlen = 0;
+  if (ftpd_send_response(client, 234, "Proceed with negotiation.") < 0) {
+    return -1;
+  }
+
+  client->ctrl_tls = ftpd_tls_accept(client->server, client->ctrl_fd);
+  if (!client->ctrl_tls) {
+    printf("ftpd: TLS handshake failed\n");
+    return -1;
+  }
+
+  /* The session starts over under TLS (RFC 4217) */
+  client->authenticated = false;
+  client->username[0] = '\0';
+  client->pbsz_set = false;
+  client->prot_private = false;
+  ftpd_path_chroot(client);
+  return 0;
+}
+
+
+int ftpd_cmd_pbsz(ftpd_client_t *client, const char *arg) {
+  if (!client->ctrl_tls) {
+    ftpd_send_response(client, 503, "Use AUTH TLS first.");
+    return 0;
+  }
+  if (!arg || arg[0] == '\0' || strspn(arg, "0123456789") != strlen(arg)) {
+    ftpd_send_response(client, 501, "Syntax error: PBSZ <size>");
+    return 0;
+  }
+
+  client->pbsz_set = true;
+  ftpd_send_response(client, 200, "PBSZ=0");
+  return 0;
+}
+
+
+int ftpd_cmd_prot(ftpd_client_t *client, const char *arg) {
+  if (!client->ctrl_tls || !client->pbsz_set) {
+    ftpd_send_response(client, 503, client->ctrl_tls ? "Use PBSZ first."
+                                                     : "Use AUTH TLS first.");
+    return 0;
+  }
+  if (!arg || arg[0] == '\0' || arg[1] != '\0') {
+    ftpd_send_response(client, 501, "Syntax error: PROT <level>");
+    return 0;
+  }
+
+  switch (toupper((unsigned char)arg[0])) {
+    case 'C':
+      client->prot_private = false;
+      ftpd_send_response(client, 200, "Protection level set to Clear.");
+      break;
+    case 'P':
+      client->prot_private = true;
+      ftpd_send_response(client, 200, "Protection level set to Private.");
+      break;
+    case 'S':
+    case 'E':
+      ftpd_send_response(client, 536, "Protection level not supported.");
+      break;
+    default:
+      ftpd_send_response(client, 504, "Unknown protection level.");
+      break;
+  }
+  return 0;
+}
 
 
 int ftpd_cmd_user(ftpd_client_t *client, const char *arg) {
@@ -36,9 +132,7 @@ int ftpd_cmd_user(ftpd_client_t *client, const char *arg) {
   client->username[sizeof(client->username) - 1] = '\0';
 
   /* Set cwd to server root (user works relative to root) */
-  strncpy(client->cwd, client->server->root_realpath,
-          sizeof(client->cwd) - 1);
-  client->cwd[sizeof(client->cwd) - 1] = '\0';
+  ftpd_path_chroot(client);
 
   client->authenticated = true;
 
@@ -83,7 +177,19 @@ int ftpd_cmd_port(ftpd_client_t *client, const char *arg) {
     return 0;
   }
 
-  /* Store (we always connect to 127.0.0.1, ignoring the IP) */
+  /* Only the client's own address, so the server is no bounce relay */
+  uint32_t addr = htonl((uint32_t)((a1 << 24) | (a2 << 16) | (a3 << 8) | a4));
+  struct sockaddr_in peer;
+  socklen_t peerlen = sizeof(peer);
+  if (getpeername(client->ctrl_fd, (struct sockaddr *)&peer, &peerlen) < 0 ||
+      peer.sin_addr.s_addr != addr) {
+    ftpd_send_response(client, 501, "PORT address must be your own.");
+    return 0;
+  }
+
+  /* Drops a passive listener taken by an earlier PASV */
+  ftpd_data_close(client);
+  client->data_addr = addr;
   client->data_port = port;
   client->data_port_set = true;
 
@@ -92,98 +198,408 @@ int ftpd_cmd_port(ftpd_client_t *client, const char *arg) {
 }
 
 
-int ftpd_cmd_stor(ftpd_client_t *client, const char *arg) {
+int ftpd_cmd_pasv(ftpd_client_t *client, const char *arg) {
+  (void)arg;
+
+  /* The configured address, or the one the client reached us on */
+  uint32_t addr = client->server->pasv_addr;
+  if (addr == 0) {
+    struct sockaddr_in local;
+    socklen_t locallen = sizeof(local);
+    if (getsockname(client->ctrl_fd, (struct sockaddr *)&local,
+                    &locallen) < 0) {
+      ftpd_send_response(client, 425, "Can't open passive connection.");
+      return 0;
+    }
+    addr = local.sin_addr.s_addr;
+  }
+
+  if (ftpd_data_listen(client) < 0) {
+    ftpd_send_response(client, 425, "Can't open passive connection.");
+    return 0;
+  }
+
+  uint32_t h = ntohl(addr);
+  uint16_t port = client->pasv_port;
+  ftpd_send_response_fmt(client, 227,
+                         "Entering Passive Mode (%u,%u,%u,%u,%u,%u).",
+                         (h >> 24) & 0xFF, (h >> 16) & 0xFF,
+                         (h >> 8) & 0xFF, h & 0xFF,
+                         (port >> 8) & 0xFF, port & 0xFF);
+  return 0;
+}
+
+
+int ftpd_cmd_epsv(ftpd_client_t *client, const char *arg) {
+  if (arg && strcasecmp(arg, "ALL") == 0) {
+    ftpd_send_response(client, 200, "EPSV ALL command successful.");
+    return 0;
+  }
+  if (arg && strcmp(arg, "1") != 0) {
+    ftpd_send_response(client, 522, "Network protocol not supported, use (1).");
+    return 0;
+  }
+
+  if (ftpd_data_listen(client) < 0) {
+    ftpd_send_response(client, 425, "Can't open passive connection.");
+    return 0;
+  }
+
+  ftpd_send_response_fmt(client, 229,
+                         "Entering Extended Passive Mode (|||%u|).",
+                         client->pasv_port);
+  return 0;
+}
+
+
+int ftpd_cmd_rest(ftpd_client_t *client, const char *arg) {
+  char *end = NULL;
+  errno = 0;
+  long long offset = arg ? strtoll(arg, &end, 10) : -1;
+  if (!arg || !isdigit((unsigned char)arg[0]) || *end != '\0' ||
+      errno == ERANGE) {
+    ftpd_send_response(client, 501, "Syntax error: REST <offset>");
+    return 0;
+  }
+
+  client->rest_offset = (off_t)offset;
+  ftpd_send_response_fmt(client, 350,
+                         "Restarting at %lld. Send STORE or RETRIEVE.",
+                         offset);
+  return 0;
+}
+
+
+int ftpd_cmd_allo(ftpd_client_t *client, const char *arg) {
+  char *end = NULL;
+  errno = 0;
+  long long size = arg ? strtoll(arg, &end, 10) : -1;
+  if (!arg || !isdigit((unsigned char)arg[0]) || errno == ERANGE ||
+      (*end != '\0' && strncmp(end, " R ", 3) != 0)) {
+    ftpd_send_response(client, 501, "Syntax error: ALLO <size>");
+    return 0;
+  }
+
+  client->alloc_size = (off_t)size;
+  ftpd_send_response(client, 200, "ALLO command successful.");
+  return 0;
+}
+
+
+/**
+ * @brief Receive a file for STOR or APPE.
+ *
+ * @param client Pointer to client structure.
+ * @param arg Filename argument.
+ * @param append Whether to append (APPE) rather than store.
+ * @return 0 to continue.
+ */
+static int store_file(ftpd_client_t *client, const char *arg, bool append) {
+  /* A REST offset applies to this transfer only */
+  off_t offset = client->rest_offset;
+  client->rest_offset = 0;
+  off_t size = client->alloc_size;
+  client->alloc_size = 0;
+
   if (!arg || arg[0] == '\0') {
-    ftpd_send_response(client, 501, "Syntax error: STOR <filename>");
+    ftpd_send_response_fmt(client, 501, "Syntax error: %s <filename>",
+                           append ? "APPE" : "STOR");
     return 0;
   }
 
   if (!client->data_port_set) {
-    ftpd_send_response(client, 425, "Use PORT first.");
+    ftpd_send_response(client, 425, "Use PORT or PASV first.");
     return 0;
   }
 
-  /* Resolve path */
-  char *filepath = ftpd_resolve_path(client, arg,
-                                     client->server->root_realpath);
-  if (!filepath) {
+  /* Only a new upload replaces the file; resuming keeps what is there */
+  int flags = O_WRONLY | O_CREAT;
+  if (!append && offset == 0) {
+    flags |= O_TRUNC;
+  }
+  int fd = ftpd_path_open(client, arg, flags, 0644);
+  if (fd < 0) {
     ftpd_send_response(client, 553, "Invalid filename.");
     return 0;
   }
 
+  /* Resuming needs the part already stored */
+  struct stat st;
+  if (!append && offset > 0 &&
+      (fstat(fd, &st) < 0 || offset > st.st_size)) {
+    ftpd_send_response(client, 554, "Restart offset beyond end of file.");
+    close(fd);
+    return 0;
+  }
+
   /* Open data connection */
   if (ftpd_data_connect(client) < 0) {
     ftpd_send_response(client, 425, "Can't open data connection.");
-    free(filepath);
+    close(fd);
     return 0;
   }
 
   ftpd_send_response(client, 150, "Opening BINARY mode data connection.");
+  if (ftpd_data_secure(client) < 0) {
+    ftpd_send_response(client, 425, "TLS negotiation failed.");
+    close(fd);
+    ftpd_data_close(client);
+    return 0;
+  }
 
   /* Receive file */
-  if (ftpd_data_recv_file(client, filepath) < 0) {
+  if (ftpd_data_recv_file(client, fd, offset, append, size) < 0) {
     ftpd_send_response(client, 426, "Transfer aborted.");
   } else {
     ftpd_send_response(client, 226, "Transfer complete.");
   }
 
   ftpd_data_close(client);
-  free(filepath);
   return 0;
 }
 
 
+int ftpd_cmd_stor(ftpd_client_t *client, const char *arg) {
+  return store_file(client, arg, false);
+}
+
+
+int ftpd_cmd_appe(ftpd_client_t *client, const char *arg) {
+  return store_file(client, arg, true);
+}
+
+
 int ftpd_cmd_retr(ftpd_client_t *client, const char *arg) {
+  /* A REST offset applies to this transfer only */
+  off_t offset = client->rest_offset;
+  client->rest_offset = 0;
+
   if (!arg || arg[0] == '\0') {
     ftpd_send_response(client, 501, "Syntax error: RETR <filename>");
     return 0;
   }
 
   if (!client->data_port_set) {
-    ftpd_send_response(client, 425, "Use PORT first.");
+    ftpd_send_response(client, 425, "Use PORT or PASV first.");
     return 0;
   }
 
-  /* Resolve path */
-  char *filepath = ftpd_resolve_path(client, arg,
-                                     client->server->root_realpath);
-  if (!filepath) {
+  /* Open the file; what is checked is what is sent */
+  int fd = ftpd_path_open(client, arg, O_RDONLY, 0);
+  if (fd < 0) {
     ftpd_send_response(client, 550, "File not found.");
     return 0;
   }
 
-  /* Check file exists and is readable */
   struct stat st;
-  if (stat(filepath, &st) < 0 || !S_ISREG(st.st_mode)) {
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
     ftpd_send_response(client, 550, "File not found or not a regular file.");
-    free(filepath);
+    close(fd);
+    return 0;
+  }
+
+  if (offset > st.st_size) {
+    ftpd_send_response(client, 554, "Restart offset beyond end of file.");
+    close(fd);
     return 0;
   }
 
   /* Open data connection */
   if (ftpd_data_connect(client) < 0) {
     ftpd_send_response(client, 425, "Can't open data connection.");
-    free(filepath);
+    close(fd);
     return 0;
   }
 
   ftpd_send_response_fmt(client, 150,
                          "Opening BINARY mode data connection (%ld bytes).",
-                         (long)st.st_size);
+                         (long)(st.st_size - offset));
+  if (ftpd_data_secure(client) < 0) {
+    ftpd_send_response(client, 425, "TLS negotiation failed.");
+    close(fd);
+    ftpd_data_close(client);
+    return 0;
+  }
 
   /* Send file */
-  if (ftpd_data_send_file(client, filepath) < 0) {
+  if (ftpd_data_send_file(client, fd, offset, arg) < 0) {
     ftpd_send_response(client, 426, "Transfer aborted.");
   } else {
     ftpd_send_response(client, 226, "Transfer complete.");
   }
 
   ftpd_data_close(client);
-  free(filepath);
   return 0;
 }
 
 
+/**
+ * @brief Stat a regular file named by a SIZE or MDTM argument.
+ *
+ * Replies with an error itself when there is no such file.
+ *
+ * @param client Pointer to client structure.
+ * @param arg Filename argument.
+ * @param cmd Command name, for the syntax error.
+ * @param st Set to the file's status.
+ * @return 0 on success, -1 if an error was sent.
+ */
+static int stat_file(ftpd_client_t *client, const char *arg, const char *cmd,
+                     struct stat *st) {
+  if (!arg || arg[0] == '\0') {
+    ftpd_send_response_fmt(client, 501, "Syntax error: %s <filename>", cmd);
+    return -1;
+  }
+
+  if (ftpd_path_stat(client, arg, st) < 0 || !S_ISREG(st->st_mode)) {
+    ftpd_send_response(client, 550, "File not found or not a regular file.");
+    return -1;
+  }
+  return 0;
+}
+
+
+int ftpd_cmd_size(ftpd_client_t *client, const char *arg) {
+  struct stat st;
+  if (stat_file(client, arg, "SIZE", &st) == 0) {
+    ftpd_send_response_fmt(client, 213, "%lld", (long long)st.st_size);
+  }
+  return 0;
+}
+
+
+int ftpd_cmd_mdtm(ftpd_client_t *client, const char *arg) {
+  struct stat st;
+  if (stat_file(client, arg, "MDTM", &st) == 0) {
+    char timebuf[32];
+    struct tm tm;
+    gmtime_r(&st.st_mtime, &tm);
+    strftime(timebuf, sizeof(timebuf), "%Y%m%d%H%M%S", &tm);
+    ftpd_send_response(client, 213, timebuf);
+  }
+  return 0;
+}
+
+
+/**
+ * @brief Digest a file named by a client, for HASH, XSHA256 and XCRC.
+ *
+ * @param client Pointer to client structure.
+ * @param arg Filename argument.
+ * @param cmd Command name, for the syntax error.
+ * @param kind Digest wanted.
+ * @param hex Set to the digest in hex; FTPD_DIGEST_HEX_MAX bytes.
+ * @param st Set to the file's status.
+ * @return 0 on success, -1 if an error was sent.
+ */
+static int digest_file(ftpd_client_t *client, const char *arg,
+                       const char *cmd, ftpd_digest_kind_t kind, char *hex,
+                       struct stat *st) {
+  if (!arg || arg[0] == '\0') {
+    ftpd_send_response_fmt(client, 501, "Syntax error: %s <filename>", cmd);
+    return -1;
+  }
+
+  /* Open the file; what is checked is what is digested */
+  int fd = ftpd_path_open(client, arg, O_RDONLY, 0);
+  if (fd < 0 || fstat(fd, st) < 0 || !S_ISREG(st->st_mode)) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    ftpd_send_response(client, 550, "File not found or not a regular file.");
+    return -1;
+  }
+
+  int rc = ftpd_digest_file(fd, kind, hex, FTPD_DIGEST_HEX_MAX);
+  close(fd);
+  if (rc < 0) {
+    ftpd_send_response(client, 451, "Digest failed.");
+    return -1;
+  }
+  return 0;
+}
+
+
+int ftpd_cmd_hash(ftpd_client_t *client, const char *arg) {
+  char hex[FTPD_DIGEST_HEX_MAX];
+  struct stat st;
+  if (digest_file(client, arg, "HASH", FTPD_DIGEST_SHA256, hex, &st) == 0) {
+    ftpd_send_response_fmt(client, 213, "SHA-256 0-%lld %s %s",
+                           (long long)st.st_size, hex, arg);
+  }
+  return 0;
+}
+
+
+int ftpd_cmd_xsha256(ftpd_client_t *client, const char *arg) {
+  char hex[FTPD_DIGEST_HEX_MAX];
+  struct stat st;
+  if (digest_file(client, arg, "XSHA256", FTPD_DIGEST_SHA256, hex,
+                  &st) == 0) {
+    ftpd_send_response(client, 250, hex);
+  }
+  return 0;
+}
+
+
+int ftpd_cmd_xcrc(ftpd_client_t *client, const char *arg) {
+  char hex[FTPD_DIGEST_HEX_MAX];
+  struct stat st;
+  if (digest_file(client, arg, "XCRC", FTPD_DIGEST_CRC32, hex, &st) == 0) {
+    ftpd_send_response(client, 250, hex);
+  }
+  return 0;
+}
+
+
+/**
+ * @brief Remove a file or an empty directory named by a client.
+ *
+ * @param client Pointer to client structure.
+ * @param arg Path argument.
+ * @param cmd Command name, for the syntax error.
+ * @param flags 0 for a file, AT_REMOVEDIR for a directory.
+ * @return 0 to continue.
+ */
+static int remove_path(ftpd_client_t *client, const char *arg,
+                       const char *cmd, int flags) {
+  if (!arg || arg[0] == '\0') {
+    ftpd_send_response_fmt(client, 501, "Syntax error: %s <path>", cmd);
+    return 0;
+  }
+
+  /* Open the parent; the name is removed beneath it */
+  char name[NAME_MAX + 1];
+  int parent = ftpd_path_parent(client, arg, name, sizeof(name));
+  if (parent < 0) {
+    ftpd_send_response(client, 553, "Invalid name.");
+    return 0;
+  }
+
+  int rc = unlinkat(parent, name, flags);
+  int err = errno;
+  close(parent);
+  if (rc < 0) {
+    ftpd_send_response_fmt(client, 550, "%s failed: %s", cmd, strerror(err));
+    return 0;
+  }
+
+  ftpd_send_response(client, 250, flags ? "Directory removed."
+                                        : "File removed.");
+  return 0;
+}
+
+
+int ftpd_cmd_dele(ftpd_client_t *client, const char *arg) {
+  return remove_path(client, arg, "DELE", 0);
+}
+
+
+int ftpd_cmd_rmd(ftpd_client_t *client, const char *arg) {
+  return remove_path(client, arg, "RMD", AT_REMOVEDIR);
+}
+
+
 /**
  * @brief Format file permissions as a string.
  *
@@ -206,113 +622,268 @@ static void format_permissions(mode_t mode, char *buf) {
 
 
 /**
- * @brief Format a directory entry in ls -l style.
+ * @brief Listing being written to the data connection.
  *
- * @param dirpath Directory path.
- * @param entry Directory entry.
- * @param buf Output buffer.
- * @param bufsize Buffer size.
- * @return Length of formatted string, or -1 on error.
+ * Entries collect in a buffer sent when full, and the owner and group
+ * names of the last entry are kept, since a directory's entries mostly
+ * share them and each lookup may read /etc/passwd.
  */
-static int format_dir_entry(const char *dirpath, struct dirent *entry,
-                            char *buf, size_t bufsize) {
-  char fullpath[PATH_MAX];
-  if (snprintf(fullpath, sizeof(fullpath), "%s/%s",
-               dirpath, entry->d_name) >= (int)sizeof(fullpath)) {
-    return -1;
+typedef struct {
+  ftpd_client_t *client;
+  char *buf;
+  size_t len;
+  bool failed;              /**< Sending failed; the rest is dropped. */
+  uid_t uid;
+  gid_t gid;
+  char owner[64];           /**< Name of uid, or "" before the first. */
+  char group[64];           /**< Name of gid, or "" before the first. */
+} ftpd_listing_t;
+
+
+/**
+ * @brief Send what a listing has collected.
+ *
+ * @param out Listing.
+ */
+static void listing_flush(ftpd_listing_t *out) {
+  if (out->len > 0 && !out->failed &&
+      ftpd_data_send(out->client, out->buf, out->len) < 0) {
+    out->failed = true;
   }
+  out->len = 0;
+}
 
-  struct stat st;
-  if (lstat(fullpath, &st) < 0) {
-    return -1;
+
+/**
+ * @brief Add a formatted line to a listing.
+ *
+ * @param out Listing.
+ * @param fmt Printf-style format string.
+ * @param ... Format arguments.
+ */
+__attribute__((format(printf, 2, 3)))
+static void listing_printf(ftpd_listing_t *out, const char *fmt, ...) {
+  for (int tries = 0; tries < 2 && !out->failed; tries++) {
+    va_list args;
+    va_start(args, fmt);
+    size_t room = FTPD_LIST_BUFFER - out->len;
+    int len = vsnprintf(out->buf + out->len, room, fmt, args);
+    va_end(args);
+
+    if (len < 0) return;
+    if ((size_t)len < room) {
+      out->len += (size_t)len;
+      return;
+    }
+    /* Did not fit; send the rest and try again in the empty buffer */
+    listing_flush(out);
   }
+}
 
+
+/**
+ * @brief Look up the owner and group names of a file.
+ *
+ * @param out Listing, holding the names last looked up.
+ * @param st File status.
+ */
+static void listing_names(ftpd_listing_t *out, const struct stat *st) {
+  char namebuf[1024];
+
+  /* Workers list directories concurrently, hence the _r variants */
+  if (!out->owner[0] || out->uid != st->st_uid) {
+    struct passwd pwbuf, *pw = NULL;
+    getpwuid_r(st->st_uid, &pwbuf, namebuf, sizeof(namebuf), &pw);
+    snprintf(out->owner, sizeof(out->owner), "%s", pw ? pw->pw_name : "?");
+    out->uid = st->st_uid;
+  }
+  if (!out->group[0] || out->gid != st->st_gid) {
+    struct group grbuf, *gr = NULL;
+    getgrgid_r(st->st_gid, &grbuf, namebuf, sizeof(namebuf), &gr);
+    snprintf(out->group, sizeof(out->group), "%s", gr ? gr->gr_name : "?");
+    out->gid = st->st_gid;
+  }
+}
+
+
+/**
+ * @brief Add a directory entry in ls -l style to a listing.
+ *
+ * @param out Listing.
+ * @param name Entry name.
+ * @param st Entry status, not following a symlink.
+ */
+static void list_entry(ftpd_listing_t *out, const char *name,
+                       const struct stat *st) {
   char perms[12];
-  format_permissions(st.st_mode, perms);
+  format_permissions(st->st_mode, perms);
+  listing_names(out, st);
 
-  /* Get owner and group names */
-  struct passwd *pw = getpwuid(st.st_uid);
-  struct group *gr = getgrgid(st.st_gid);
-  const char *owner = pw ? pw->pw_name : "?";
-  const char *group = gr ? gr->gr_name : "?";
+  char timebuf[32];
+  struct tm tm;
+  localtime_r(&st->st_mtime, &tm);
+  strftime(timebuf, sizeof(timebuf), "%b %d %H:%M", &tm);
+
+  listing_printf(out, "%s %3lu %-8s %-8s %8ld %s %s\r\n",
+                 perms,
+                 (unsigned long)st->st_nlink,
+                 out->owner,
+                 out->group,
+                 (long)st->st_size,
+                 timebuf,
+                 name);
+}
+
+
+/**
+ * @brief Format the facts of a file as MLSD and MLST give them.
+ *
+ * The facts are always type, size, modify and perm, in that order. The
+ * perm letters follow the mode bits that apply to the server's user.
+ *
+ * @param st File status.
+ * @param buf Output buffer.
+ * @param bufsize Buffer size.
+ */
+static void format_facts(const struct stat *st, char *buf, size_t bufsize) {
+  mode_t bits;
+  if (geteuid() == 0) {
+    bits = 06 | ((st->st_mode & 0111) ? 01 : 0);
+  } else if (st->st_uid == geteuid()) {
+    bits = (st->st_mode >> 6) & 07;
+  } else if (st->st_gid == getegid()) {
+    bits = (st->st_mode >> 3) & 07;
+  } else {
+    bits = st->st_mode & 07;
+  }
+
+  char perm[8];
+  size_t n = 0;
+  const char *type;
+  if (S_ISDIR(st->st_mode)) {
+    type = "dir";
+    if ((bits & 05) == 05) {
+      perm[n++] = 'e';
+      perm[n++] = 'l';
+    }
+    if ((bits & 03) == 03) {
+      perm[n++] = 'c';
+      perm[n++] = 'm';
+    }
+  } else {
+    type = S_ISREG(st->st_mode) ? "file" : "OS.unix=special";
+    if (bits & 04) perm[n++] = 'r';
+    if (bits & 02) {
+      perm[n++] = 'a';
+      perm[n++] = 'w';
+    }
+  }
+  perm[n] = '\0';
 
-  /* Format time */
   char timebuf[32];
-  struct tm *tm = localtime(&st.st_mtime);
-  strftime(timebuf, sizeof(timebuf), "%b %d %H:%M", tm);
+  struct tm tm;
+  gmtime_r(&st->st_mtime, &tm);
+  strftime(timebuf, sizeof(timebuf), "%Y%m%d%H%M%S", &tm);
 
-  return snprintf(buf, bufsize, "%s %3lu %-8s %-8s %8ld %s %s\r\n",
-                  perms,
-                  (unsigned long)st.st_nlink,
-                  owner,
-                  group,
-                  (long)st.st_size,
-                  timebuf,
-                  entry->d_name);
+  snprintf(buf, bufsize, "type=%s;size=%lld;modify=%s;perm=%s;",
+           type, (long long)st->st_size, timebuf, perm);
 }
 
 
-int ftpd_cmd_list(ftpd_client_t *client, const char *arg) {
+/**
+ * @brief Send a directory listing, for LIST or MLSD.
+ *
+ * Entries are looked up with fstatat() relative to the directory, which
+ * saves building and resolving a path for each.
+ *
+ * @param client Pointer to client structure.
+ * @param arg Optional path argument (defaults to cwd).
+ * @param facts true for MLSD facts, false for ls -l lines.
+ * @return 0 to continue.
+ */
+static int send_listing(ftpd_client_t *client, const char *arg, bool facts) {
   if (!client->data_port_set) {
-    ftpd_send_response(client, 425, "Use PORT first.");
+    ftpd_send_response(client, 425, "Use PORT or PASV first.");
     return 0;
   }
 
-  /* Resolve path */
-  char *dirpath = ftpd_resolve_path(client, arg,
-                                    client->server->root_realpath);
-  if (!dirpath) {
-    dirpath = strdup(client->cwd);
-    if (!dirpath) {
-      ftpd_send_response(client, 550, "Memory error.");
-      return 0;
-    }
+  /* Open directory; LIST falls back to the cwd for options like -la */
+  int dfd = ftpd_path_open(client, arg, O_RDONLY | O_DIRECTORY, 0);
+  if (dfd < 0 && facts && arg && arg[0]) {
+    ftpd_send_response(client, 550, "Directory not found.");
+    return 0;
   }
-
-  /* Open directory */
-  DIR *dir = opendir(dirpath);
+  if (dfd < 0) {
+    dfd = ftpd_path_open(client, NULL, O_RDONLY | O_DIRECTORY, 0);
+  }
+  DIR *dir = dfd >= 0 ? fdopendir(dfd) : NULL;
   if (!dir) {
+    if (dfd >= 0) {
+      close(dfd);
+    }
     ftpd_send_response(client, 550, "Failed to open directory.");
-    free(dirpath);
+    return 0;
+  }
+
+  ftpd_listing_t out = { .client = client };
+  out.buf = malloc(FTPD_LIST_BUFFER);
+  if (!out.buf) {
+    ftpd_send_response(client, 451, "Memory error.");
+    closedir(dir);
     return 0;
   }
 
   /* Open data connection */
   if (ftpd_data_connect(client) < 0) {
     ftpd_send_response(client, 425, "Can't open data connection.");
+    free(out.buf);
     closedir(dir);
-    free(dirpath);
     return 0;
   }
 
   ftpd_send_response(client, 150, "Opening ASCII mode data connection.");
+  if (ftpd_data_secure(client) < 0) {
+    ftpd_send_response(client, 425, "TLS negotiation failed.");
+    free(out.buf);
+    closedir(dir);
+    ftpd_data_close(client);
+    return 0;
+  }
 
   /* Send directory listing */
+  int flags = facts ? 0 : AT_SYMLINK_NOFOLLOW;
   struct dirent *entry;
-  char linebuf[512];
-  int result = 0;
 
-  while ((entry = readdir(dir)) != NULL) {
+  while (!out.failed && (entry = readdir(dir)) != NULL) {
     /* Skip . and .. */
     if (strcmp(entry->d_name, ".") == 0 ||
         strcmp(entry->d_name, "..") == 0) {
       continue;
     }
 
-    int len = format_dir_entry(dirpath, entry, linebuf, sizeof(linebuf));
-    if (len > 0) {
-      if (ftpd_data_send(client, linebuf, (size_t)len) < 0) {
-        result = -1;
-        break;
-      }
+    struct stat st;
+    if (fstatat(dfd, entry->d_name, &st, flags) < 0) {
+      continue;
+    }
+
+    if (facts) {
+      char factbuf[128];
+      format_facts(&st, factbuf, sizeof(factbuf));
+      listing_printf(&out, "%s %s\r\n", factbuf, entry->d_name);
+    } else {
+      list_entry(&out, entry->d_name, &st);
     }
   }
+  listing_flush(&out);
+  if (!out.failed && ftpd_data_finish(client) < 0) {
+    out.failed = true;
+  }
 
   closedir(dir);
+  free(out.buf);
   ftpd_data_close(client);
-  free(dirpath);
 
-  if (result < 0) {
+  if (out.failed) {
     ftpd_send_response(client, 426, "Transfer aborted.");
   } else {
     ftpd_send_response(client, 226, "Transfer complete.");
@@ -322,38 +893,136 @@ int ftpd_cmd_list(ftpd_client_t *client, const char *arg) {
 }
 
 
+int ftpd_cmd_list(ftpd_client_t *client, const char *arg) {
+  return send_listing(client, arg, false);
+}
+
+
+int ftpd_cmd_mlsd(ftpd_client_t *client, const char *arg) {
+  return send_listing(client, arg, true);
+}
+
+
+int ftpd_cmd_mlst(ftpd_client_t *client, const char *arg) {
+  struct stat st;
+  char displaypath[PATH_MAX];
+  if (ftpd_path_stat(client, arg, &st) < 0 ||
+      !ftpd_path_display(client, arg, displaypath, sizeof(displaypath))) {
+    ftpd_send_response(client, 550, "File not found.");
+    return 0;
+  }
+
+  char factbuf[128];
+  format_facts(&st, factbuf, sizeof(factbuf));
+
+  char reply[PATH_MAX + 256];
+  int len = snprintf(reply, sizeof(reply),
+                     "250-Listing %s\r\n %s %s\r\n250 End.\r\n",
+                     displaypath, factbuf, displaypath);
+  if (len < 0 || len >= (int)sizeof(reply)) {
+    ftpd_send_response(client, 550, "Path too long.");
+    return 0;
+  }
+  ftpd_send_raw(client, reply, (size_t)len);
+  return 0;
+}
+
+
+int ftpd_cmd_feat(ftpd_client_t *client, const char *arg) {
+  (void)arg;
+
+  static const char features[] =
+      "211-Features:\r\n"
+      " EPSV\r\n"
+      " HASH SHA-256*;\r\n"
+      " MDTM\r\n"
+      " MLST type*;size*;modify*;perm*;\r\n"
+      " MODE Z\r\n"
+      " PASV\r\n"
+      " REST STREAM\r\n"
+      " SIZE\r\n"
+      " XCRC\r\n"
+      " XSHA256\r\n";
+  static const char tls_features[] =
+      " AUTH TLS\r\n"
+      " PBSZ\r\n"
+      " PROT\r\n";
+  static const char end[] = "211 End.\r\n";
+
+  if (ftpd_send_raw(client, features, sizeof(features) - 1) == 0 &&
+      (!client->server->tls_ctx ||
+       ftpd_send_raw(client, tls_features, sizeof(tls_features) - 1) == 0)) {
+    ftpd_send_raw(client, end, sizeof(end) - 1);
+  }
+  return 0;
+}
+
+
+int ftpd_cmd_site(ftpd_client_t *client, const char *arg) {
+  if (!arg || arg[0] == '\0') {
+    ftpd_send_response(client, 501, "Syntax error: SITE <command>");
+    return 0;
+  }
+  if (strcasecmp(arg, "STATS") != 0) {
+    ftpd_send_response(client, 504, "SITE command not implemented.");
+    return 0;
+  }
+
+  size_t len;
+  char *json = ftpd_stats_format(client->server, FTPD_STATS_JSON, &len);
+  if (!json) {
+    ftpd_send_response(client, 451, "Out of memory.");
+    return 0;
+  }
+
+  /* The JSON is one line; the reply wraps it in 211 lines */
+  static const char head[] = "211-Server statistics:\r\n ";
+  static const char tail[] = "\r\n211 End.\r\n";
+  if (len > 0 && json[len - 1] == '\n') {
+    len--;
+  }
+  if (ftpd_send_raw(client, head, sizeof(head) - 1) == 0 &&
+      ftpd_send_raw(client, json, len) == 0) {
+    ftpd_send_raw(client, tail, sizeof(tail) - 1);
+  }
+  free(json);
+  return 0;
+}
+
+
 int ftpd_cmd_mkd(ftpd_client_t *client, const char *arg) {
   if (!arg || arg[0] == '\0') {
     ftpd_send_response(client, 501, "Syntax error: MKD <dirname>");
     return 0;
   }
 
-  /* Resolve path */
-  char *dirpath = ftpd_resolve_path(client, arg,
-                                    client->server->root_realpath);
-  if (!dirpath) {
+  /* Open the parent; the new name is created beneath it */
+  char name[NAME_MAX + 1];
+  char displaypath[PATH_MAX];
+  int parent = ftpd_path_parent(client, arg, name, sizeof(name));
+  if (parent < 0 ||
+      !ftpd_path_display(client, arg, displaypath, sizeof(displaypath))) {
+    if (parent >= 0) {
+      close(parent);
+    }
     ftpd_send_response(client, 553, "Invalid directory name.");
     return 0;
   }
 
   /* Create directory */
-  if (mkdir(dirpath, 0755) < 0) {
-    if (errno == EEXIST) {
+  int rc = mkdirat(parent, name, 0755);
+  int err = errno;
+  close(parent);
+  if (rc < 0) {
+    if (err == EEXIST) {
       ftpd_send_response(client, 550, "Directory already exists.");
     } else {
-      ftpd_send_response_fmt(client, 550, "mkdir failed: %s", strerror(errno));
+      ftpd_send_response_fmt(client, 550, "mkdir failed: %s", strerror(err));
     }
-    free(dirpath);
     return 0;
   }
 
-  /* Get display path */
-  char displaypath[PATH_MAX];
-  ftpd_path_to_display(dirpath, client->server->root_realpath,
-                       displaypath, sizeof(displaypath));
-
   ftpd_send_response_fmt(client, 257, "\"%s\" directory created.", displaypath);
-  free(dirpath);
   return 0;
 }
 
@@ -361,12 +1030,8 @@ int ftpd_cmd_mkd(ftpd_client_t *client, const char *arg) {
 int ftpd_cmd_pwd(ftpd_client_t *client, const char *arg) {
   (void)arg;
 
-  char displaypath[PATH_MAX];
-  ftpd_path_to_display(client->cwd, client->server->root_realpath,
-                       displaypath, sizeof(displaypath));
-
   ftpd_send_response_fmt(client, 257, "\"%s\" is current directory.",
-                         displaypath);
+                         client->cwd);
   return 0;
 }
 
@@ -377,27 +1042,13 @@ int ftpd_cmd_cwd(ftpd_client_t *client, const char *arg) {
     return 0;
   }
 
-  /* Resolve path */
-  char *newpath = ftpd_resolve_path(client, arg,
-                                    client->server->root_realpath);
-  if (!newpath) {
-    ftpd_send_response(client, 550, "Failed to change directory.");
+  if (ftpd_path_chdir(client, arg) < 0) {
+    ftpd_send_response(client, 550, errno == ENOTDIR
+                                        ? "Not a directory."
+                                        : "Failed to change directory.");
     return 0;
   }
 
-  /* Check it's a directory */
-  struct stat st;
-  if (stat(newpath, &st) < 0 || !S_ISDIR(st.st_mode)) {
-    ftpd_send_response(client, 550, "Not a directory.");
-    free(newpath);
-    return 0;
-  }
-
-  /* Update cwd */
-  strncpy(client->cwd, newpath, sizeof(client->cwd) - 1);
-  client->cwd[sizeof(client->cwd) - 1] = '\0';
-  free(newpath);
-
   ftpd_send_response(client, 250, "Directory changed.");
   return 0;
 }
@@ -411,6 +1062,49 @@ int ftpd_cmd_type(ftpd_client_t *client, const char *arg) {
 }
 
 
+int ftpd_cmd_mode(ftpd_client_t *client, const char *arg) {
+  if (!arg || arg[0] == '\0' || arg[1] != '\0') {
+    ftpd_send_response(client, 501, "Syntax error: MODE S or MODE Z");
+    return 0;
+  }
+
+  switch (toupper((unsigned char)arg[0])) {
+    case 'S':
+      client->mode_z = false;
+      ftpd_send_response(client, 200, "Mode set to S.");
+      break;
+    case 'Z':
+      client->mode_z = true;
+      ftpd_send_response(client, 200, "Mode set to Z.");
+      break;
+    default:
+      ftpd_send_response(client, 504, "Unsupported transfer mode.");
+      break;
+  }
+  return 0;
+}
+
+
+int ftpd_cmd_opts(ftpd_client_t *client, const char *arg) {
+  static const char level_opt[] = "MODE Z LEVEL ";
+  if (!arg || strncasecmp(arg, level_opt, sizeof(level_opt) - 1) != 0) {
+    ftpd_send_response(client, 501, "Option not understood.");
+    return 0;
+  }
+
+  const char *value = arg + sizeof(level_opt) - 1;
+  char *end;
+  long level = strtol(value, &end, 10);
+  if (end == value || *end != '\0' || level < 0 || level > 9) {
+    ftpd_send_response(client, 501, "MODE Z LEVEL must be 0 to 9.");
+    return 0;
+  }
+  client->z_level = (int)level;
+  ftpd_send_response_fmt(client, 200, "MODE Z LEVEL set to %ld.", level);
+  return 0;
+}
+
+
 int ftpd_cmd_syst(ftpd_client_t *client, const char *arg) {
   (void)arg;
   ftpd_send_response(client, 215, "UNIX Type: L8");
@@ -12,6 +12,45 @@
 #include "ftpd.h"
 
 
+/**
+ * @brief Handle AUTH command - make the control connection a TLS one.
+ *
+ * Replies 234 and does the handshake, on a worker. The session starts
+ * over: the client logs in again and data is clear until PROT P.
+ * Commands sent in the clear behind AUTH are dropped.
+ *
+ * @param client Pointer to client structure.
+ * @param arg Mechanism, TLS (or TLS-C, or SSL for old clients).
+ * @return 0 to continue, -1 to disconnect after a failed handshake.
+ */
+int ftpd_cmd_auth(ftpd_client_t *client, const char *arg);
+
+
+/**
+ * @brief Handle PBSZ command - set the protection buffer size.
+ *
+ * TLS needs no buffer, so the size is always 0.
+ *
+ * @param client Pointer to client structure.
+ * @param arg Buffer size.
+ * @return 0 to continue.
+ */
+int ftpd_cmd_pbsz(ftpd_client_t *client, const char *arg);
+
+
+/**
+ * @brief Handle PROT command - set the data protection level.
+ *
+ * C leaves data connections clear; P makes them TLS connections, on
+ * which clients may resume the control connection's session.
+ *
+ * @param client Pointer to client structure.
+ * @param arg Level, C or P.
+ * @return 0 to continue.
+ */
+int ftpd_cmd_prot(ftpd_client_t *client, const char *arg);
+
+
 /**
  * @brief Handle USER command - set username.
  *
@@ -41,8 +80,8 @@ int ftpd_cmd_quit(ftpd_client_t *client, const char *arg);
  * @brief Handle PORT command - set data connection address.
  *
  * Parses the PORT argument in format "a1,a2,a3,a4,p1,p2" where
- * the IP is a1.a2.a3.a4 and port is p1*256+p2.
- * Server always connects to 127.0.0.1 regardless of IP provided.
+ * the IP is a1.a2.a3.a4 and port is p1*256+p2. The IP must be the
+ * client's own, so the server cannot be made to connect elsewhere.
  *
  * @param client Pointer to client structure.
  * @param arg PORT argument string.
@@ -51,12 +90,67 @@ int ftpd_cmd_quit(ftpd_client_t *client, const char *arg);
 int ftpd_cmd_port(ftpd_client_t *client, const char *arg);
 
 
+/**
+ * @brief Handle PASV command - wait for the client's data connection.
+ *
+ * Takes a passive data listener and replies with its address in
+ * format "h1,h2,h3,h4,p1,p2".
+ *
+ * @param client Pointer to client structure.
+ * @param arg Unused argument.
+ * @return 0 to continue.
+ */
+int ftpd_cmd_pasv(ftpd_client_t *client, const char *arg);
+
+
+/**
+ * @brief Handle EPSV command - extended passive mode (RFC 2428).
+ *
+ * Like PASV, but replies with the port only, the client connecting
+ * to the address it already uses. Only network protocol 1 (IPv4) is
+ * supported; "EPSV ALL" is acknowledged.
+ *
+ * @param client Pointer to client structure.
+ * @param arg Optional network protocol or "ALL".
+ * @return 0 to continue.
+ */
+int ftpd_cmd_epsv(ftpd_client_t *client, const char *arg);
+
+
+/**
+ * @brief Handle REST command - set the restart offset.
+ *
+ * The next RETR starts sending, or the next STOR starts writing,
+ * at the given byte offset, so an interrupted transfer can resume.
+ *
+ * @param client Pointer to client structure.
+ * @param arg Decimal byte offset.
+ * @return 0 to continue.
+ */
+int ftpd_cmd_rest(ftpd_client_t *client, const char *arg);
+
+
+/**
+ * @brief Handle ALLO command - announce the size of the next upload.
+ *
+ * The next STOR or APPE preallocates that many bytes, so the file is
+ * laid out in one piece and a full disk is found before the transfer.
+ * A record size ("R <size>") is accepted and ignored.
+ *
+ * @param client Pointer to client structure.
+ * @param arg Decimal byte count.
+ * @return 0 to continue.
+ */
+int ftpd_cmd_allo(ftpd_client_t *client, const char *arg);
+
+
 /**
  * @brief Handle STOR command - upload file from client.
  *
  * Receives a file from the client over the data connection
- * and stores it in the client's current directory.
- * Requires prior PORT command.
+ * and stores it in the client's current directory. After REST,
+ * the file is kept up to the offset and written from there.
+ * Requires prior PORT or PASV command.
  *
  * @param client Pointer to client structure.
  * @param arg Filename argument.
@@ -65,11 +159,24 @@ int ftpd_cmd_port(ftpd_client_t *client, const char *arg);
 int ftpd_cmd_stor(ftpd_client_t *client, const char *arg);
 
 
+/**
+ * @brief Handle APPE command - append upload to a file.
+ *
+ * Like STOR, but writes after the end of an existing file.
+ *
+ * @param client Pointer to client structure.
+ * @param arg Filename argument.
+ * @return 0 on success, -1 on error.
+ */
+int ftpd_cmd_appe(ftpd_client_t *client, const char *arg);
+
+
 /**
  * @brief Handle RETR command - download file to client.
  *
- * Sends a file to the client over the data connection.
- * Requires prior PORT command.
+ * Sends a file to the client over the data connection, from the
+ * REST offset if one was given.
+ * Requires prior PORT or PASV command.
  *
  * @param client Pointer to client structure.
  * @param arg Filename argument.
@@ -78,11 +185,94 @@ int ftpd_cmd_stor(ftpd_client_t *client, const char *arg);
 int ftpd_cmd_retr(ftpd_client_t *client, const char *arg);
 
 
+/**
+ * @brief Handle SIZE command - report a file's size (RFC 3659).
+ *
+ * @param client Pointer to client structure.
+ * @param arg Filename argument.
+ * @return 0 to continue.
+ */
+int ftpd_cmd_size(ftpd_client_t *client, const char *arg);
+
+
+/**
+ * @brief Handle MDTM command - report a file's modification time.
+ *
+ * Replies with the time in UTC as YYYYMMDDHHMMSS (RFC 3659).
+ *
+ * @param client Pointer to client structure.
+ * @param arg Filename argument.
+ * @return 0 to continue.
+ */
+int ftpd_cmd_mdtm(ftpd_client_t *client, const char *arg);
+
+
+/**
+ * @brief Handle HASH command - report a file's SHA-256 digest.
+ *
+ * Replies "213 SHA-256 0-<size> <hex> <name>", after the HASH draft
+ * (draft-bryan-ftpext-hash), so a client can tell whether its copy
+ * matches without fetching the file. The digest is cached with the
+ * file (see ftpd_digest.h); without a cache the whole file is read, so
+ * this runs on a worker.
+ *
+ * @param client Pointer to client structure.
+ * @param arg Filename argument.
+ * @return 0 to continue.
+ */
+int ftpd_cmd_hash(ftpd_client_t *client, const char *arg);
+
+
+/**
+ * @brief Handle XSHA256 command - report a file's SHA-256 digest.
+ *
+ * Replies "250 <hex>", as other servers do; the digest is HASH's.
+ *
+ * @param client Pointer to client structure.
+ * @param arg Filename argument.
+ * @return 0 to continue.
+ */
+int ftpd_cmd_xsha256(ftpd_client_t *client, const char *arg);
+
+
+/**
+ * @brief Handle XCRC command - report a file's CRC-32.
+ *
+ * Replies "250 <hex>" for the whole file; computed and cached along
+ * with the SHA-256.
+ *
+ * @param client Pointer to client structure.
+ * @param arg Filename argument.
+ * @return 0 to continue.
+ */
+int ftpd_cmd_xcrc(ftpd_client_t *client, const char *arg);
+
+
+/**
+ * @brief Handle DELE command - remove a file.
+ *
+ * @param client Pointer to client structure.
+ * @param arg Filename argument.
+ * @return 0 to continue.
+ */
+int ftpd_cmd_dele(ftpd_client_t *client, const char *arg);
+
+
+/**
+ * @brief Handle RMD command - remove an empty directory.
+ *
+ * @param client Pointer to client structure.
+ * @param arg Directory name argument.
+ * @return 0 to continue.
+ */
+int ftpd_cmd_rmd(ftpd_client_t *client, const char *arg);
+
+
 /**
  * @brief Handle LIST command - list directory contents.
  *
  * Sends an ls -l style directory listing over the data connection.
- * Requires prior PORT command.
+ * Requires prior PORT or PASV command.
  *
  * @param client Pointer to client structure.
  * @param arg Optional path argument (defaults to cwd).
@@ -91,6 +281,55 @@ int ftpd_cmd_retr(ftpd_client_t *client, const char *arg);
 int ftpd_cmd_list(ftpd_client_t *client, const char *arg);
 
 
+/**
+ * @brief Handle MLSD command - list directory contents for machines.
+ *
+ * Sends one line per entry over the data connection, as in RFC 3659:
+ * the facts type, size, modify and perm, always in that order, then a
+ * space and the name. Requires prior PORT or PASV command.
+ *
+ * @param client Pointer to client structure.
+ * @param arg Optional directory (defaults to cwd).
+ * @return 0 to continue.
+ */
+int ftpd_cmd_mlsd(ftpd_client_t *client, const char *arg);
+
+
+/**
+ * @brief Handle MLST command - give the facts of one file.
+ *
+ * Replies over the control connection with the same facts as MLSD.
+ *
+ * @param client Pointer to client structure.
+ * @param arg Optional path (defaults to cwd).
+ * @return 0 to continue.
+ */
+int ftpd_cmd_mlst(ftpd_client_t *client, const char *arg);
+
+
+/**
+ * @brief Handle FEAT command - list the extensions the server knows.
+ *
+ * @param client Pointer to client structure.
+ * @param arg Unused.
+ * @return 0 to continue.
+ */
+int ftpd_cmd_feat(ftpd_client_t *client, const char *arg);
+
+
+/**
+ * @brief Handle SITE command - server-specific commands.
+ *
+ * SITE STATS sends the server's statistics as one line of JSON in a
+ * multi-line 211 reply.
+ *
+ * @param client Pointer to client structure.
+ * @param arg SITE command and its arguments.
+ * @return 0 to continue.
+ */
+int ftpd_cmd_site(ftpd_client_t *client, const char *arg);
+
+
 /**
  * @brief Handle MKD command - create directory.
  *
@@ -139,6 +378,32 @@ int ftpd_cmd_cwd(ftpd_client_t *client, const char *arg);
 int ftpd_cmd_type(ftpd_client_t *client, const char *arg);
 
 
+/**
+ * @brief Handle MODE command - set transfer mode.
+ *
+ * S (stream) sends data as it is; Z deflates it into one zlib stream
+ * per transfer, listings included. Others are refused with 504.
+ *
+ * @param client Pointer to client structure.
+ * @param arg Mode argument (S or Z).
+ * @return 0 always.
+ */
+int ftpd_cmd_mode(ftpd_client_t *client, const char *arg);
+
+
+/**
+ * @brief Handle OPTS command - set options of a command.
+ *
+ * Knows "MODE Z LEVEL <0-9>", the deflate level of later MODE Z
+ * transfers.
+ *
+ * @param client Pointer to client structure.
+ * @param arg Command and its options.
+ * @return 0 always.
+ */
+int ftpd_cmd_opts(ftpd_client_t *client, const char *arg);
+
+
 /**
  * @brief Handle SYST command - system type.
  *
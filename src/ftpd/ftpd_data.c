@@ -4,22 +4,321 @@
  *
  * This module handles the data connection for file transfers.
  * In active mode (PORT), the server connects to the client's data port.
+ * In passive mode (PASV, EPSV), the client connects to a listener the
+ * server took from a pool of listeners kept bound between transfers,
+ * so that PASV costs no socket setup; connections from any address
+ * but the client's own are refused.
+ *
+ * File contents do not pass through user space when the kernel can
+ * avoid it: RETR uses sendfile() and STOR splices from the socket into
+ * a pipe and from the pipe into the file. The data socket is corked, so
+ * LIST lines and the ends of files go out in full segments.
+ *
+ * Uploads are written behind: every few megabytes the kernel is told
+ * to start writing what came in, and the previous stretch, by then on
+ * disk, is dropped from the page cache. Large uploads at once so leave
+ * a bounded amount of dirty cache each rather than pushing out
+ * everything else, and the disk sees long sequential writes into space
+ * preallocated from the size given with ALLO.
+ *
+ * After PROT P the data connection is a TLS one. Files are still sent
+ * with sendfile() when the kernel does the encryption (kernel TLS);
+ * otherwise data goes through OpenSSL, downloads read ahead by jbox_aio
+ * so the disk and the encryption overlap, uploads through a buffer.
+ *
+ * Under a rate limit each call moves at most one bucket's burst, and the
+ * worker sleeps off whatever the client's or the server's bucket owes
+ * before the next one.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <zlib.h>
 
 #include "ftpd.h"
 #include "ftpd_data.h"
+#include "ftpd_digest.h"
+#include "ftpd_stats.h"
+#include "ftpd_tls.h"
+#include "utils/jbox_aio.h"
+#include "utils/jbox_gzip.h"
+
+
+/** Bytes asked of each sendfile() or splice() call. */
+#define FTPD_SPLICE_CHUNK (1024 * 1024)
+
+/** How long to wait for a client's TLS close_notify, in ms. */
+#define FTPD_CLOSE_NOTIFY_MS 2000
+
+/** Bytes of an upload handed to the disk at a time. */
+#define FTPD_WRITE_BEHIND (8 * 1024 * 1024)
+
+/** Bytes of a download the disk is asked to read ahead of the sending. */
+#define FTPD_READAHEAD (8 * 1024 * 1024)
+
+
+/**
+ * @brief Write-behind state of a file being uploaded.
+ */
+typedef struct {
+  int fd;           /**< File written. */
+  off_t pos;        /**< End of the data written so far. */
+  off_t started;    /**< End of the data being written out to disk. */
+  off_t dropped;    /**< End of the data dropped from the page cache. */
+} writeback_t;
+
+
+/**
+ * @brief Write all of a buffer to a file.
+ *
+ * @param fd File descriptor.
+ * @param buf Data to write.
+ * @param len Length of data.
+ * @return 0 on success, -1 on error.
+ */
+static int write_all(int fd, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    buf += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+
+/**
+ * @brief Whether a splice or sendfile error means it is unsupported.
+ *
+ * @param err errno of the failed call.
+ * @return true if copying through a buffer may still work.
+ */
+static bool splice_unsupported(int err) {
+  return err == EINVAL || err == ENOSYS || err == EOPNOTSUPP;
+}
+
+
+/**
+ * @brief Cork a data socket.
+ *
+ * Sends only full segments until the connection is closed.
+ *
+ * @param sock Data socket.
+ */
+static void cork(int sock) {
+  int optval = 1;
+  setsockopt(sock, IPPROTO_TCP, TCP_CORK, &optval, sizeof(optval));
+}
+
+
+/**
+ * @brief Open a passive data listener.
+ *
+ * Binds to the next free port of the configured range, or to any
+ * port if there is none. Must be called with pasv_lock held.
+ *
+ * @param server Pointer to server structure.
+ * @param port Set to the port bound.
+ * @return Listening socket, or -1 on error.
+ */
+static int open_listener(ftpd_server_t *server, uint16_t *port) {
+  int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (sock < 0) {
+    return -1;
+  }
+
+  int optval = 1;
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+
+  struct sockaddr_in addr = {
+    .sin_family = AF_INET,
+    .sin_addr.s_addr = htonl(INADDR_ANY),
+    .sin_port = 0
+  };
+
+  unsigned int min = server->config.pasv_min_port;
+  unsigned int range = min ? server->config.pasv_max_port - min + 1 : 1;
+  int bound = -1;
+  for (unsigned int i = 0; i < range && bound < 0; i++) {
+    if (min) {
+      addr.sin_port = htons((uint16_t)(min + server->pasv_next++ % range));
+    }
+    bound = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+    if (bound < 0 && errno != EADDRINUSE) {
+      break;
+    }
+  }
+
+  socklen_t addrlen = sizeof(addr);
+  if (bound < 0 || listen(sock, 1) < 0 ||
+      getsockname(sock, (struct sockaddr *)&addr, &addrlen) < 0) {
+    close(sock);
+    return -1;
+  }
+
+  *port = ntohs(addr.sin_port);
+  return sock;
+}
+
+
+/**
+ * @brief Return a passive listener to the pool, or close it.
+ *
+ * @param server Pointer to server structure.
+ * @param sock Listening socket.
+ * @param port Its port.
+ */
+static void release_listener(ftpd_server_t *server, int sock,
+                             uint16_t port) {
+  pthread_mutex_lock(&server->pasv_lock);
+  if (server->pasv_count < FTPD_PASV_POOL) {
+    server->pasv_pool[server->pasv_count] = sock;
+    server->pasv_ports[server->pasv_count] = port;
+    server->pasv_count++;
+    sock = -1;
+  }
+  pthread_mutex_unlock(&server->pasv_lock);
+
+  if (sock >= 0) {
+    close(sock);
+  }
+}
+
+
+/**
+ * @brief Accept the client's connection on its passive listener.
+ *
+ * Connections from other addresses are closed and waiting goes on.
+ *
+ * @param client Pointer to client structure with pasv_fd set.
+ * @return Data socket, or -1 on error or timeout.
+ */
+static int accept_passive(ftpd_client_t *client) {
+  struct sockaddr_in peer;
+  socklen_t peerlen = sizeof(peer);
+  if (getpeername(client->ctrl_fd, (struct sockaddr *)&peer, &peerlen) < 0) {
+    return -1;
+  }
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (;;) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long elapsed = (now.tv_sec - start.tv_sec) * 1000 +
+                   (now.tv_nsec - start.tv_nsec) / 1000000;
+    if (elapsed >= FTPD_DATA_TIMEOUT_MS) {
+      return -1;
+    }
+
+    struct pollfd pfd = { .fd = client->pasv_fd, .events = POLLIN };
+    int ready = poll(&pfd, 1, (int)(FTPD_DATA_TIMEOUT_MS - elapsed));
+    if (ready < 0 && errno != EINTR) {
+      return -1;
+    }
+    if (ready <= 0) {
+      continue;
+    }
+
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    int sock = accept4(client->pasv_fd, (struct sockaddr *)&addr,
+                       &addrlen, SOCK_CLOEXEC);
+    if (sock < 0) {
+      if (errno == EAGAIN || errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      return -1;
+    }
+    if (addr.sin_addr.s_addr == peer.sin_addr.s_addr) {
+      return sock;
+    }
+    close(sock);
+  }
+}
+
+
+int ftpd_data_listen(ftpd_client_t *client) {
+  if (!client) {
+    return -1;
+  }
+
+  ftpd_server_t *server = client->server;
+  ftpd_data_close(client);
+
+  int sock = -1;
+  uint16_t port = 0;
+  pthread_mutex_lock(&server->pasv_lock);
+  if (server->pasv_count > 0) {
+    server->pasv_count--;
+    sock = server->pasv_pool[server->pasv_count];
+    port = server->pasv_ports[server->pasv_count];
+  } else {
+    sock = open_listener(server, &port);
+  }
+  pthread_mutex_unlock(&server->pasv_lock);
+  if (sock < 0) {
+    return -1;
+  }
+
+  /* Drop connections left over from the listener's last use */
+  int stale;
+  while ((stale = accept4(sock, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+    close(stale);
+  }
+
+  client->pasv_fd = sock;
+  client->pasv_port = port;
+  client->data_port_set = true;
+  return 0;
+}
+
+
+void ftpd_data_pool_fill(ftpd_server_t *server) {
+  pthread_mutex_lock(&server->pasv_lock);
+  while (server->pasv_count < FTPD_PASV_POOL) {
+    uint16_t port;
+    int sock = open_listener(server, &port);
+    if (sock < 0) {
+      break;
+    }
+    server->pasv_pool[server->pasv_count] = sock;
+    server->pasv_ports[server->pasv_count] = port;
+    server->pasv_count++;
+  }
+  pthread_mutex_unlock(&server->pasv_lock);
+}
+
+
+void ftpd_data_pool_free(ftpd_server_t *server) {
+  pthread_mutex_lock(&server->pasv_lock);
+  for (int i = 0; i < server->pasv_count; i++) {
+    close(server->pasv_pool[i]);
+  }
+  server->pasv_count = 0;
+  pthread_mutex_unlock(&server->pasv_lock);
+}
 
 
 int ftpd_data_connect(ftpd_client_t *client) {
@@ -27,8 +326,21 @@ int ftpd_data_connect(ftpd_client_t *client) {
     return -1;
   }
 
+  if (client->pasv_fd >= 0) {
+    int sock = accept_passive(client);
+    release_listener(client->server, client->pasv_fd, client->pasv_port);
+    client->pasv_fd = -1;
+    if (sock < 0) {
+      perror("ftpd: data accept");
+      return -1;
+    }
+    cork(sock);
+    client->data_fd = sock;
+    return 0;
+  }
+
   /* Create socket */
-  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
   if (sock < 0) {
     perror("ftpd: data socket");
     return -1;
@@ -37,7 +349,7 @@ int ftpd_data_connect(ftpd_client_t *client) {
   /* Connect to client's data port */
   struct sockaddr_in data_addr = {
     .sin_family = AF_INET,
-    .sin_addr.s_addr = htonl(INADDR_LOOPBACK),  /* Always use 127.0.0.1 */
+    .sin_addr.s_addr = client->data_addr,
     .sin_port = htons(client->data_port)
   };
 
@@ -47,35 +359,119 @@ int ftpd_data_connect(ftpd_client_t *client) {
     return -1;
   }
 
+  cork(sock);
   client->data_fd = sock;
   return 0;
 }
 
 
-ssize_t ftpd_data_send(ftpd_client_t *client, const void *data, size_t len) {
-  if (!client || client->data_fd < 0 || !data) {
+int ftpd_data_secure(ftpd_client_t *client) {
+  if (!client || client->data_fd < 0) {
     return -1;
   }
+  if (!client->prot_private || client->data_tls) {
+    return 0;
+  }
+
+  client->data_tls = ftpd_tls_accept(client->server, client->data_fd);
+  return client->data_tls ? 0 : -1;
+}
 
-  const char *ptr = (const char *)data;
-  size_t remaining = len;
 
-  while (remaining > 0) {
-    ssize_t n = send(client->data_fd, ptr, remaining, 0);
+/**
+ * @brief Write all of a buffer to the data connection.
+ *
+ * @param client Pointer to client structure with data_fd set.
+ * @param buf Data to send.
+ * @param len Length of data.
+ * @return 0 on success, -1 on error.
+ */
+static int send_all(ftpd_client_t *client, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = client->data_tls
+                ? ftpd_tls_write(client->data_tls, buf, len)
+                : send(client->data_fd, buf, len, 0);
     if (n < 0) {
       if (errno == EINTR) {
         continue;
       }
       return -1;
     }
-    ptr += n;
-    remaining -= (size_t)n;
+    buf += n;
+    len -= (size_t)n;
   }
+  return 0;
+}
 
+
+/**
+ * @brief Send what the MODE Z deflater of ftpd_data_send() puts out.
+ *
+ * @param ctx Pointer to client structure.
+ * @param data Deflated bytes.
+ * @param len Number of bytes.
+ * @return 0 on success, -1 on error.
+ */
+static int send_sink(void *ctx, const void *data, size_t len) {
+  ftpd_client_t *client = ctx;
+  if (send_all(client, data, len) < 0) {
+    return -1;
+  }
+
+  ftpd_stats_add(client->server->stats, FTPD_COUNT_BYTES_OUT, len);
+  return 0;
+}
+
+
+ssize_t ftpd_data_send(ftpd_client_t *client, const void *data, size_t len) {
+  if (!client || client->data_fd < 0 || !data) {
+    return -1;
+  }
+
+  if (client->mode_z) {
+    if (!client->data_z) {
+      client->data_z = jbox_gzip_zlib_writer_new(send_sink, client,
+                                                 client->z_level, 1);
+      if (!client->data_z) {
+        return -1;
+      }
+    }
+    return jbox_gzip_write(client->data_z, data, len) < 0 ? -1
+                                                          : (ssize_t)len;
+  }
+
+  if (send_all(client, data, len) < 0) {
+    return -1;
+  }
+
+  ftpd_stats_add(client->server->stats, FTPD_COUNT_BYTES_OUT, len);
   return (ssize_t)len;
 }
 
 
+int ftpd_data_finish(ftpd_client_t *client) {
+  if (!client || !client->mode_z) {
+    return 0;
+  }
+
+  /* Nothing to send is still a stream, an empty one */
+  if (!client->data_z) {
+    if (client->data_fd < 0) {
+      return -1;
+    }
+    client->data_z = jbox_gzip_zlib_writer_new(send_sink, client,
+                                               client->z_level, 1);
+    if (!client->data_z) {
+      return -1;
+    }
+  }
+
+  int result = jbox_gzip_writer_close(client->data_z, true);
+  client->data_z = NULL;
+  return result;
+}
+
+
 ssize_t ftpd_data_recv(ftpd_client_t *client, void *buf, size_t len) {
   if (!client || client->data_fd < 0 || !buf) {
     return -1;
@@ -83,78 +479,597 @@ ssize_t ftpd_data_recv(ftpd_client_t *client, void *buf, size_t len) {
 
   ssize_t n;
   do {
-    n = recv(client->data_fd, buf, len, 0);
+    n = client->data_tls ? ftpd_tls_read(client->data_tls, buf, len)
+                         : recv(client->data_fd, buf, len, 0);
   } while (n < 0 && errno == EINTR);
 
   return n;
 }
 
 
-int ftpd_data_send_file(ftpd_client_t *client, const char *filepath) {
-  if (!client || !filepath || client->data_fd < 0) {
+/**
+ * @brief Bytes to move in one call under the client's rate limits.
+ *
+ * @param client Pointer to client structure.
+ * @param max Most bytes wanted.
+ * @return Bytes to ask for.
+ */
+static size_t transfer_chunk(ftpd_client_t *client, size_t max) {
+  max = ftpd_bucket_chunk(&client->rate, max);
+  return ftpd_bucket_chunk(&client->server->total_rate, max);
+}
+
+
+/**
+ * @brief Count moved bytes and charge them to the client's and the
+ *        server's buckets, sleeping until both are out of debt.
+ *
+ * @param client Pointer to client structure.
+ * @param counter FTPD_COUNT_BYTES_IN or FTPD_COUNT_BYTES_OUT.
+ * @param bytes Bytes just moved.
+ */
+static void account(ftpd_client_t *client, ftpd_counter_t counter,
+                    size_t bytes) {
+  ftpd_stats_add(client->server->stats, counter, bytes);
+
+  double wait = ftpd_bucket_charge(&client->rate, bytes);
+  double total = ftpd_bucket_charge(&client->server->total_rate, bytes);
+  if (total > wait) {
+    wait = total;
+  }
+  if (wait <= 0) {
+    return;
+  }
+
+  struct timespec ts = {
+    .tv_sec = (time_t)wait,
+    .tv_nsec = (long)((wait - (double)(time_t)wait) * 1e9),
+  };
+  while (nanosleep(&ts, &ts) < 0 && errno == EINTR) {
+  }
+}
+
+
+/**
+ * @brief Note bytes written to an upload, starting writeback of each
+ *        full stretch and dropping the one before from the cache.
+ *
+ * @param wb Write-behind state of the file.
+ * @param bytes Bytes just written.
+ */
+static void write_behind(writeback_t *wb, size_t bytes) {
+  wb->pos += (off_t)bytes;
+  if (wb->pos - wb->started < FTPD_WRITE_BEHIND) {
+    return;
+  }
+
+  sync_file_range(wb->fd, wb->started, wb->pos - wb->started,
+                  SYNC_FILE_RANGE_WRITE);
+  /* The stretch before has had a whole stretch's time to reach disk */
+  if (wb->started > wb->dropped) {
+    sync_file_range(wb->fd, wb->dropped, wb->started - wb->dropped,
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                    SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(wb->fd, wb->dropped, wb->started - wb->dropped,
+                  POSIX_FADV_DONTNEED);
+    wb->dropped = wb->started;
+  }
+  wb->started = wb->pos;
+}
+
+
+/**
+ * @brief Copy from the data connection into a file through a buffer.
+ *
+ * @param client Pointer to client structure, for its data connection
+ *        and rate limits.
+ * @param fd File to write.
+ * @param wb Write-behind state of fd.
+ * @return 0 on success, -1 on error.
+ */
+static int copy_buffered(ftpd_client_t *client, int fd, writeback_t *wb,
+                         ftpd_digest_t *digest) {
+  char *buf = malloc(FTPD_BUFFER_SIZE);
+  if (!buf) {
     return -1;
   }
 
-  int fd = open(filepath, O_RDONLY);
-  if (fd < 0) {
+  size_t chunk = transfer_chunk(client, FTPD_BUFFER_SIZE);
+  int result = 0;
+  for (;;) {
+    ssize_t n = ftpd_data_recv(client, buf, chunk);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      result = n < 0 ? -1 : 0;
+      break;
+    }
+    if (write_all(fd, buf, (size_t)n) < 0) {
+      result = -1;
+      break;
+    }
+    if (digest) {
+      ftpd_digest_update(digest, buf, (size_t)n);
+    }
+    write_behind(wb, (size_t)n);
+    account(client, FTPD_COUNT_BYTES_IN, (size_t)n);
+  }
+
+  free(buf);
+  return result;
+}
+
+
+/**
+ * @brief Keep the disk reading a stretch ahead of a download, so that
+ *        sending does not wait for it.
+ *
+ * Each time the download is halfway through the stretch asked for, the
+ * next one is asked for with POSIX_FADV_WILLNEED.
+ *
+ * @param fd File being sent.
+ * @param pos Offset sent up to.
+ * @param advised Offset read ahead up to; updated.
+ */
+static void read_ahead(int fd, off_t pos, off_t *advised) {
+  if (*advised - pos > FTPD_READAHEAD / 2) {
+    return;
+  }
+  posix_fadvise(fd, *advised, FTPD_READAHEAD, POSIX_FADV_WILLNEED);
+  *advised += FTPD_READAHEAD;
+}
+
+
+/**
+ * @brief Send a file over the data connection through user space, the
+ *        next blocks being read while each one is sent.
+ *
+ * @param client Pointer to client structure, for its data connection
+ *        and rate limits.
+ * @param fd File to send.
+ * @param offset Where in the file to start, fd being there already.
+ * @return 0 on success, -1 on error.
+ */
+static int send_buffered(ftpd_client_t *client, int fd, off_t offset) {
+  jbox_aio_t *aio = jbox_aio_open(fd, transfer_chunk(client,
+                                                     FTPD_BUFFER_SIZE));
+  if (!aio) {
     return -1;
   }
 
-  char buf[FTPD_BUFFER_SIZE];
-  ssize_t n;
+  off_t advised = offset;
   int result = 0;
+  for (;;) {
+    read_ahead(fd, offset, &advised);
+    const char *data;
+    ssize_t n = jbox_aio_read(aio, &data);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      result = n < 0 ? -1 : 0;
+      break;
+    }
+    if (send_all(client, data, (size_t)n) < 0) {
+      result = -1;
+      break;
+    }
+    account(client, FTPD_COUNT_BYTES_OUT, (size_t)n);
+    offset += n;
+  }
+
+  jbox_aio_close(aio);
+  return result;
+}
+
+
+/**
+ * @brief Send what a MODE Z download deflates, under the rate limits.
+ *
+ * @param ctx Pointer to client structure.
+ * @param data Deflated bytes.
+ * @param len Number of bytes.
+ * @return 0 on success, -1 on error.
+ */
+static int transfer_sink(void *ctx, const void *data, size_t len) {
+  ftpd_client_t *client = ctx;
+  const char *p = data;
+  while (len > 0) {
+    size_t n = transfer_chunk(client, len);
+    if (send_all(client, p, n) < 0) {
+      return -1;
+    }
+    account(client, FTPD_COUNT_BYTES_OUT, n);
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+
+/**
+ * @brief Start deflating a download, for MODE Z.
+ *
+ * A file whose name says it is compressed already goes out in stored
+ * blocks, which cost next to nothing to make; a large one is deflated
+ * on several threads.
+ *
+ * @param client Pointer to client structure.
+ * @param size Bytes to send.
+ * @param name Name of the file, for its extension.
+ * @return Deflater sending to the client, or NULL if out of memory.
+ */
+static jbox_gzip_writer_t *open_deflater(ftpd_client_t *client, off_t size,
+                                         const char *name) {
+  int level = name && jbox_gzip_compressed_name(name) ? 0 : client->z_level;
+  int threads = level > 0 && size >= FTPD_ZLIB_PARALLEL ? FTPD_ZLIB_THREADS
+                                                        : 1;
+  return jbox_gzip_zlib_writer_new(transfer_sink, client, level, threads);
+}
+
 
-  while ((n = read(fd, buf, sizeof(buf))) > 0) {
-    if (ftpd_data_send(client, buf, (size_t)n) < 0) {
+/**
+ * @brief Send a file deflated, for MODE Z.
+ *
+ * @param client Pointer to client structure.
+ * @param fd File to send.
+ * @param offset Where in the file to start, fd being there already.
+ * @param size Bytes left in the file when the transfer starts.
+ * @param name Name of the file, for its extension.
+ * @return 0 on success, -1 on error.
+ */
+static int send_deflated(ftpd_client_t *client, int fd, off_t offset,
+                         off_t size, const char *name) {
+  jbox_gzip_writer_t *z = open_deflater(client, size, name);
+  if (!z) {
+    return -1;
+  }
+  jbox_aio_t *aio = jbox_aio_open(fd, FTPD_BUFFER_SIZE);
+  if (!aio) {
+    jbox_gzip_writer_close(z, false);
+    return -1;
+  }
+
+  off_t advised = offset;
+  int result = 0;
+  for (;;) {
+    read_ahead(fd, offset, &advised);
+    const char *data;
+    ssize_t n = jbox_aio_read(aio, &data);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      result = n < 0 ? -1 : 0;
+      break;
+    }
+    if (jbox_gzip_write(z, data, (size_t)n) < 0) {
       result = -1;
       break;
     }
+    offset += n;
   }
 
-  if (n < 0) {
+  jbox_aio_close(aio);
+  if (jbox_gzip_writer_close(z, result == 0) < 0) {
     result = -1;
   }
+  return result;
+}
 
-  close(fd);
+
+/**
+ * @brief Send a download from the file cache.
+ *
+ * @param client Pointer to client structure.
+ * @param data Contents of the file from the offset to send from.
+ * @param len Bytes to send.
+ * @param name Name of the file, for MODE Z.
+ * @return 0 on success, -1 on error.
+ */
+static int send_cached(ftpd_client_t *client, const char *data, size_t len,
+                       const char *name) {
+  if (!client->mode_z) {
+    return transfer_sink(client, data, len);
+  }
+
+  jbox_gzip_writer_t *z = open_deflater(client, (off_t)len, name);
+  if (!z) {
+    return -1;
+  }
+  int result = jbox_gzip_write(z, data, len);
+  if (jbox_gzip_writer_close(z, result == 0) < 0) {
+    result = -1;
+  }
   return result;
 }
 
 
-int ftpd_data_recv_file(ftpd_client_t *client, const char *filepath) {
-  if (!client || !filepath || client->data_fd < 0) {
+/**
+ * @brief Send a file with sendfile(), falling back to user space where
+ *        the kernel cannot.
+ *
+ * @param client Pointer to client structure.
+ * @param fd File to send.
+ * @param offset Where in the file to start, fd being there already.
+ * @return 0 on success, -1 on error.
+ */
+static int send_kernel(ftpd_client_t *client, int fd, off_t offset) {
+  /* Until EOF rather than st_size, in case the file grows */
+  size_t chunk = transfer_chunk(client, FTPD_SPLICE_CHUNK);
+  bool sent = false;
+  off_t pos = offset;
+  off_t advised = offset;
+  for (;;) {
+    read_ahead(fd, pos, &advised);
+    ssize_t n;
+    if (client->data_tls) {
+      n = ftpd_tls_sendfile(client->data_tls, fd, pos, chunk);
+      pos += n > 0 ? n : 0;
+    } else {
+      n = sendfile(client->data_fd, fd, &pos, chunk);
+    }
+    if (n > 0) {
+      sent = true;
+      account(client, FTPD_COUNT_BYTES_OUT, (size_t)n);
+      continue;
+    }
+    if (n == 0) {
+      return 0;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    return !sent && splice_unsupported(errno)
+           ? send_buffered(client, fd, offset) : -1;
+  }
+}
+
+
+int ftpd_data_send_file(ftpd_client_t *client, int fd, off_t offset,
+                        const char *name) {
+  if (!client || client->data_fd < 0) {
+    if (fd >= 0) {
+      close(fd);
+    }
     return -1;
   }
 
-  int fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-  if (fd < 0) {
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (offset > 0 && lseek(fd, offset, SEEK_SET) < 0)) {
+    close(fd);
     return -1;
   }
+  posix_fadvise(fd, offset, 0, POSIX_FADV_SEQUENTIAL);
 
-  char buf[FTPD_BUFFER_SIZE];
-  ssize_t n;
+  /* A small file goes from memory, read once for all its downloads */
+  uint64_t start = ftpd_stats_now();
+  bool hit;
+  const ftpd_cache_entry_t *cached = ftpd_cache_get(&client->server->cache,
+                                                    fd, &st, &hit);
+  int result;
+  if (cached && offset <= cached->size) {
+    ftpd_stats_add(client->server->stats,
+                   hit ? FTPD_COUNT_CACHE_HITS : FTPD_COUNT_CACHE_MISSES, 1);
+    result = send_cached(client, cached->data + offset,
+                         (size_t)(cached->size - offset), name);
+  } else if (client->mode_z) {
+    result = send_deflated(client, fd, offset, st.st_size - offset, name);
+  } else {
+    result = send_kernel(client, fd, offset);
+  }
+  ftpd_cache_release(&client->server->cache, cached);
+
+  close(fd);
+  if (result == 0) {
+    ftpd_stats_time(client->server->stats, FTPD_TIME_DOWNLOAD,
+                    ftpd_stats_now() - start);
+  }
+  return result;
+}
+
+
+/**
+ * @brief Splice the data socket into a file through a pipe.
+ *
+ * @param client Pointer to client structure; reads its data socket.
+ * @param wb Write-behind state of the file to write.
+ * @return 0 on success, 1 if splicing is unsupported and nothing has
+ *         been read, -1 on error.
+ */
+static int splice_to_file(ftpd_client_t *client, writeback_t *wb) {
+  int pipefd[2];
+  if (pipe2(pipefd, O_CLOEXEC) < 0) {
+    return 1;
+  }
+  /* A larger pipe moves more per call; the default still works */
+  fcntl(pipefd[1], F_SETPIPE_SZ, FTPD_SPLICE_CHUNK);
+
+  size_t chunk = transfer_chunk(client, FTPD_SPLICE_CHUNK);
   int result = 0;
+  bool moved = false;
+  for (;;) {
+    ssize_t n = splice(client->data_fd, NULL, pipefd[1], NULL, chunk,
+                       SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      result = !moved && splice_unsupported(errno) ? 1 : -1;
+      break;
+    }
+    if (n == 0) {
+      break;
+    }
+    moved = true;
+    size_t received = (size_t)n;
 
-  while ((n = ftpd_data_recv(client, buf, sizeof(buf))) > 0) {
-    ssize_t written = 0;
-    while (written < n) {
-      ssize_t w = write(fd, buf + written, (size_t)(n - written));
-      if (w < 0) {
-        if (errno == EINTR) {
-          continue;
-        }
+    /* Drain the pipe into the file */
+    while (n > 0) {
+      ssize_t m = splice(pipefd[0], NULL, wb->fd, NULL, (size_t)n,
+                         SPLICE_F_MOVE | SPLICE_F_MORE);
+      if (m < 0 && errno == EINTR) {
+        continue;
+      }
+      if (m <= 0) {
         result = -1;
         goto done;
       }
-      written += w;
+      n -= m;
     }
+    write_behind(wb, received);
+    account(client, FTPD_COUNT_BYTES_IN, received);
   }
 
-  if (n < 0) {
-    result = -1;
+done:
+  close(pipefd[0]);
+  close(pipefd[1]);
+  return result;
+}
+
+
+/**
+ * @brief Inflate a MODE Z upload from the data connection into a file.
+ *
+ * The stream ends itself; a connection closed before its end is an
+ * error rather than a shorter file.
+ *
+ * @param client Pointer to client structure, for its data connection
+ *        and rate limits.
+ * @param fd File to write.
+ * @param wb Write-behind state of fd.
+ * @param digest Digest to update with the inflated bytes, or NULL.
+ * @return 0 on success, -1 on error.
+ */
+static int copy_inflated(ftpd_client_t *client, int fd, writeback_t *wb,
+                         ftpd_digest_t *digest) {
+  unsigned char *in = malloc(FTPD_BUFFER_SIZE);
+  unsigned char *out = malloc(FTPD_BUFFER_SIZE);
+  z_stream z = {0};
+  if (!in || !out || inflateInit(&z) != Z_OK) {
+    free(in);
+    free(out);
+    return -1;
+  }
+
+  size_t chunk = transfer_chunk(client, FTPD_BUFFER_SIZE);
+  int rc = Z_OK;
+  while (rc != Z_STREAM_END) {
+    ssize_t n = ftpd_data_recv(client, in, chunk);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    account(client, FTPD_COUNT_BYTES_IN, (size_t)n);
+
+    z.next_in = in;
+    z.avail_in = (uInt)n;
+    do {
+      z.next_out = out;
+      z.avail_out = FTPD_BUFFER_SIZE;
+      rc = inflate(&z, Z_NO_FLUSH);
+      if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
+        goto done;
+      }
+      size_t have = FTPD_BUFFER_SIZE - z.avail_out;
+      if (write_all(fd, (const char *)out, have) < 0) {
+        rc = Z_ERRNO;
+        goto done;
+      }
+      if (digest) {
+        ftpd_digest_update(digest, out, have);
+      }
+      write_behind(wb, have);
+    } while (z.avail_out == 0 && rc != Z_STREAM_END);
   }
 
 done:
-  close(fd);
+  inflateEnd(&z);
+  free(in);
+  free(out);
+  return rc == Z_STREAM_END ? 0 : -1;
+}
+
+
+int ftpd_data_recv_file(ftpd_client_t *client, int fd, off_t offset,
+                        bool append, off_t size) {
+  if (!client || client->data_fd < 0) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+
+  /* Seek rather than O_APPEND, which splice() refuses to write to */
+  struct stat st;
+  if (append || offset > 0) {
+    if (fstat(fd, &st) < 0 || (!append && offset > st.st_size)) {
+      close(fd);
+      return -1;
+    }
+    if (append) {
+      offset = st.st_size;
+    } else if (ftruncate(fd, offset) < 0) {
+      close(fd);
+      return -1;
+    }
+    if (lseek(fd, offset, SEEK_SET) < 0) {
+      close(fd);
+      return -1;
+    }
+  }
+
+  /* Reserve the space in one piece; the file keeps its size */
+  if (size > 0 && fallocate(fd, FALLOC_FL_KEEP_SIZE, offset, size) < 0 &&
+      errno == ENOSPC) {
+    close(fd);
+    return -1;
+  }
+
+  /* A whole file can be digested as it arrives, through a buffer */
+  ftpd_digest_t digest;
+  bool digesting = client->server->config.digest_uploads && !append &&
+                   offset == 0;
+  if (digesting) {
+    ftpd_digest_init(&digest);
+  }
+
+  uint64_t start = ftpd_stats_now();
+  writeback_t wb = { .fd = fd, .pos = offset, .started = offset,
+                     .dropped = offset };
+  /* The kernel cannot splice what OpenSSL has to decrypt */
+  int result;
+  if (client->mode_z) {
+    result = copy_inflated(client, fd, &wb, digesting ? &digest : NULL);
+  } else {
+    result = client->data_tls || digesting ? 1 : splice_to_file(client, &wb);
+  }
+  if (result > 0) {
+    result = copy_buffered(client, fd, &wb, digesting ? &digest : NULL);
+  }
+
+  /* Give back what a shorter upload than announced did not fill */
+  if (size > 0 && wb.pos < offset + size) {
+    fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, wb.pos,
+              offset + size - wb.pos);
+  }
+  if (result == 0 && client->server->config.fsync_uploads &&
+      fdatasync(fd) < 0) {
+    result = -1;
+  }
+  if (result == 0 && digesting) {
+    ftpd_digest_store(&digest, fd);
+  }
+  if (close(fd) < 0) {
+    result = -1;
+  }
+  if (result == 0) {
+    ftpd_stats_time(client->server->stats, FTPD_TIME_UPLOAD,
+                    ftpd_stats_now() - start);
+  }
   return result;
 }
 
@@ -164,11 +1079,22 @@ void ftpd_data_close(ftpd_client_t *client) {
     return;
   }
 
+  /* A stream not finished by now was cut short; drop it unended */
+  jbox_gzip_writer_close(client->data_z, false);
+  client->data_z = NULL;
+
+  ftpd_tls_close(client->data_tls, FTPD_CLOSE_NOTIFY_MS);
+  client->data_tls = NULL;
   if (client->data_fd >= 0) {
     close(client->data_fd);
     client->data_fd = -1;
   }
 
+  if (client->pasv_fd >= 0) {
+    release_listener(client->server, client->pasv_fd, client->pasv_port);
+    client->pasv_fd = -1;
+  }
+
   /* Reset port setting after data transfer */
   client->data_port_set = false;
 }
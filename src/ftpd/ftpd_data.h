@@ -12,13 +12,16 @@
 
 #include "ftpd.h"
 #include <stddef.h>
+#include <sys/types.h>
 
 
 /**
  * @brief Establish data connection to client.
  *
  * Connects to the client's data port as specified by a prior
- * PORT command. The connection is stored in client->data_fd.
+ * PORT command, or after PASV or EPSV accepts the client's
+ * connection, waiting up to FTPD_DATA_TIMEOUT_MS for it.
+ * The connection is stored in client->data_fd.
  *
  * @param client Pointer to client structure with data_port set.
  * @return 0 on success, -1 on error.
@@ -26,10 +29,53 @@
 int ftpd_data_connect(ftpd_client_t *client);
 
 
+/**
+ * @brief Make the data connection a TLS one if PROT P is in effect.
+ *
+ * Called after the 150 reply, which the client waits for before it
+ * starts the handshake.
+ *
+ * @param client Pointer to client structure with data_fd set.
+ * @return 0 on success or without PROT P, -1 if the handshake failed.
+ */
+int ftpd_data_secure(ftpd_client_t *client);
+
+
+/**
+ * @brief Take a passive data listener for a client.
+ *
+ * Reuses a listener from the server's pool, already bound and
+ * listening, or opens one in the configured port range. Any
+ * earlier PORT or PASV setting is dropped.
+ *
+ * @param client Pointer to client structure; pasv_fd and pasv_port
+ *        are set on success.
+ * @return 0 on success, -1 on error.
+ */
+int ftpd_data_listen(ftpd_client_t *client);
+
+
+/**
+ * @brief Fill the server's pool of passive data listeners.
+ *
+ * @param server Pointer to server structure.
+ */
+void ftpd_data_pool_fill(ftpd_server_t *server);
+
+
+/**
+ * @brief Close the listeners in the server's pool.
+ *
+ * @param server Pointer to server structure.
+ */
+void ftpd_data_pool_free(ftpd_server_t *server);
+
+
 /**
  * @brief Send data over the data connection.
  *
- * Writes data to the established data connection.
+ * Writes data to the established data connection. In MODE Z the data
+ * is deflated on its way, and ftpd_data_finish() must end the stream.
  *
  * @param client Pointer to client structure with data_fd set.
  * @param data Pointer to data buffer.
@@ -39,6 +85,18 @@ int ftpd_data_connect(ftpd_client_t *client);
 ssize_t ftpd_data_send(ftpd_client_t *client, const void *data, size_t len);
 
 
+/**
+ * @brief End what ftpd_data_send() has sent.
+ *
+ * In MODE Z this flushes the deflater and ends the stream, sending an
+ * empty one if nothing was sent; otherwise it does nothing.
+ *
+ * @param client Pointer to client structure with data_fd set.
+ * @return 0 on success, -1 on error.
+ */
+int ftpd_data_finish(ftpd_client_t *client);
+
+
 /**
  * @brief Receive data from the data connection.
  *
@@ -55,34 +113,64 @@ ssize_t ftpd_data_recv(ftpd_client_t *client, void *buf, size_t len);
 /**
  * @brief Send a file over the data connection.
  *
- * Opens the specified file and sends its contents over
- * the data connection. The data connection must already
- * be established.
+ * Sends the contents of an open file over the data connection
+ * with sendfile(), falling back to read() and send(). Over TLS the
+ * kernel encrypts what sendfile() sends if it does kernel TLS for the
+ * connection; otherwise OpenSSL encrypts from a buffer. The data
+ * connection must already be established. A small file is sent from
+ * the server's file cache instead, and the disk is kept reading ahead
+ * of a large one.
+ *
+ * In MODE Z the file is deflated instead, on several threads if it is
+ * large, and in stored blocks if its name says it is compressed
+ * already.
  *
  * @param client Pointer to client structure.
- * @param filepath Path to file to send.
+ * @param fd File to send, open for reading; closed on return.
+ * @param offset Byte to start from, as given by REST.
+ * @param name Name of the file, for MODE Z; may be NULL.
  * @return 0 on success, -1 on error.
  */
-int ftpd_data_send_file(ftpd_client_t *client, const char *filepath);
+int ftpd_data_send_file(ftpd_client_t *client, int fd, off_t offset,
+                        const char *name);
 
 
 /**
  * @brief Receive a file over the data connection.
  *
  * Receives data from the data connection and writes it
- * to the specified file. Creates the file if it doesn't exist.
+ * to an open file, moving it through a pipe with
+ * splice() or, failing that or over TLS, through a buffer.
+ * Written data is handed to the disk every few megabytes and then
+ * dropped from the page cache; with config.fsync_uploads the file
+ * is on disk before this returns. With config.digest_uploads a whole
+ * file (no REST or APPE) goes through the buffer and is digested on
+ * the way, and its digests are cached for HASH. In MODE Z the data is
+ * inflated into the file, and a connection closed before the end of
+ * the stream fails the upload.
  *
  * @param client Pointer to client structure.
- * @param filepath Path to file to create/overwrite.
- * @return 0 on success, -1 on error.
+ * @param fd File to write, open for writing and not O_APPEND; closed
+ *        on return.
+ * @param offset Byte to start writing at, as given by REST; the file
+ *        is cut there first and must be at least that long.
+ * @param append Whether to write after the end of the file (APPE)
+ *        instead, ignoring offset.
+ * @param size Bytes the client announced with ALLO, preallocated
+ *        before writing; 0 for none.
+ * @return 0 on success, -1 on error (also when the file system has no
+ *         room for size bytes).
  */
-int ftpd_data_recv_file(ftpd_client_t *client, const char *filepath);
+int ftpd_data_recv_file(ftpd_client_t *client, int fd, off_t offset,
+                        bool append, off_t size);
 
 
 /**
  * @brief Close the data connection.
  *
- * Closes the data connection socket and resets data_fd to -1.
+ * Closes the data connection socket and resets data_fd to -1,
+ * after a TLS close_notify exchange if it is a TLS connection.
+ * A passive listener goes back to the server's pool.
  *
  * @param client Pointer to client structure.
  */
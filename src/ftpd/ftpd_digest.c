@@ -0,0 +1,170 @@
+/**
+ * @file ftpd_digest.c
+ * @brief Digests of files for HASH, XSHA256 and XCRC, cached with the
+ *        files.
+ *
+ * SHA-256 runs on the CPU's SHA extensions where it has them, and
+ * zlib's CRC-32 on its carry-less multiply; the file is read once for
+ * both, the next block being read while each one is digested.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <zlib.h>
+
+#include "ftpd_digest.h"
+#include "utils/jbox_aio.h"
+
+
+/** Bytes read at a time while digesting a file. */
+#define FTPD_DIGEST_CHUNK (1024 * 1024)
+
+/** Room for the cached value: key and both digests. */
+#define FTPD_DIGEST_VALUE_MAX 192
+
+
+/**
+ * @brief Format a file's cache key: the state its digests are of.
+ *
+ * @param st The file's status.
+ * @param buf Output buffer, FTPD_DIGEST_VALUE_MAX bytes.
+ * @return Length of the key.
+ */
+static int format_key(const struct stat *st, char *buf) {
+  return snprintf(buf, FTPD_DIGEST_VALUE_MAX, "1 %" PRIu64 " %lld %lld.%09ld",
+                  (uint64_t)st->st_ino, (long long)st->st_size,
+                  (long long)st->st_mtim.tv_sec, st->st_mtim.tv_nsec);
+}
+
+
+/**
+ * @brief Copy the wanted digest into the caller's buffer.
+ *
+ * @param kind Digest wanted.
+ * @param sha256 SHA-256 in hex.
+ * @param crc32 CRC-32.
+ * @param hex Output buffer.
+ * @param hexsize Size of hex.
+ * @return 0 on success, -1 if hex is too small.
+ */
+static int give(ftpd_digest_kind_t kind, const char *sha256, uint32_t crc32,
+                char *hex, size_t hexsize) {
+  int len = kind == FTPD_DIGEST_SHA256
+                ? snprintf(hex, hexsize, "%s", sha256)
+                : snprintf(hex, hexsize, "%08" PRIx32, crc32);
+  return len >= 0 && (size_t)len < hexsize ? 0 : -1;
+}
+
+
+/**
+ * @brief Finish the digests and cache them on a file.
+ *
+ * @param digest Digest state of everything in the file.
+ * @param fd The file.
+ * @param before The file's status when digesting began, or NULL; if it
+ *        has changed since, the digests may be of neither state, and
+ *        are not cached.
+ * @param sha256 Set to the SHA-256 in hex.
+ */
+static void finish(ftpd_digest_t *digest, int fd, const struct stat *before,
+                   char sha256[FTPD_DIGEST_HEX_MAX]) {
+  uint8_t bytes[JBOX_SHA256_LEN];
+  jbox_sha256_final(&digest->sha256, bytes);
+  jbox_hash_hex(bytes, sizeof(bytes), sha256);
+
+  struct stat st;
+  char value[FTPD_DIGEST_VALUE_MAX];
+  if (fstat(fd, &st) < 0 ||
+      (before && (st.st_size != before->st_size ||
+                  st.st_mtim.tv_sec != before->st_mtim.tv_sec ||
+                  st.st_mtim.tv_nsec != before->st_mtim.tv_nsec))) {
+    return;
+  }
+  int len = format_key(&st, value);
+  len += snprintf(value + len, sizeof(value) - (size_t)len,
+                  " %s %08" PRIx32, sha256, digest->crc32);
+  fsetxattr(fd, FTPD_DIGEST_XATTR, value, (size_t)len, 0);
+}
+
+
+void ftpd_digest_init(ftpd_digest_t *digest) {
+  jbox_sha256_init(&digest->sha256);
+  digest->crc32 = (uint32_t)crc32(0, Z_NULL, 0);
+}
+
+
+void ftpd_digest_update(ftpd_digest_t *digest, const void *data,
+                        size_t len) {
+  jbox_sha256_update(&digest->sha256, data, len);
+  /* zlib takes at most a uInt at a time */
+  const unsigned char *p = data;
+  while (len > 0) {
+    uInt n = len > UINT32_MAX ? UINT32_MAX : (uInt)len;
+    digest->crc32 = (uint32_t)crc32(digest->crc32, p, n);
+    p += n;
+    len -= n;
+  }
+}
+
+
+void ftpd_digest_store(ftpd_digest_t *digest, int fd) {
+  char sha256[FTPD_DIGEST_HEX_MAX];
+  finish(digest, fd, NULL, sha256);
+}
+
+
+int ftpd_digest_file(int fd, ftpd_digest_kind_t kind, char *hex,
+                     size_t hexsize) {
+  /* The cache holds if it was made for this very state of the file */
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    return -1;
+  }
+  char value[FTPD_DIGEST_VALUE_MAX];
+  char key[FTPD_DIGEST_VALUE_MAX];
+  ssize_t len = fgetxattr(fd, FTPD_DIGEST_XATTR, value, sizeof(value) - 1);
+  int key_len = format_key(&st, key);
+  if (len > key_len && memcmp(value, key, (size_t)key_len) == 0 &&
+      value[key_len] == ' ') {
+    value[len] = '\0';
+    char sha256[FTPD_DIGEST_HEX_MAX];
+    uint32_t crc32;
+    if (sscanf(value + key_len, " %64[0-9a-f] %8" SCNx32, sha256,
+               &crc32) == 2 &&
+        strlen(sha256) == 2 * JBOX_SHA256_LEN) {
+      return give(kind, sha256, crc32, hex, hexsize);
+    }
+  }
+
+  jbox_aio_t *aio = jbox_aio_open(fd, FTPD_DIGEST_CHUNK);
+  if (!aio) {
+    return -1;
+  }
+  ftpd_digest_t digest;
+  ftpd_digest_init(&digest);
+  int result = 0;
+  for (;;) {
+    const char *data;
+    ssize_t n = jbox_aio_read(aio, &data);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      result = n < 0 ? -1 : 0;
+      break;
+    }
+    ftpd_digest_update(&digest, data, (size_t)n);
+  }
+  jbox_aio_close(aio);
+  if (result < 0) {
+    return -1;
+  }
+
+  char sha256[FTPD_DIGEST_HEX_MAX];
+  finish(&digest, fd, &st, sha256);
+  return give(kind, sha256, digest.crc32, hex, hexsize);
+}
@@ -0,0 +1,95 @@
+/**
+ * @file ftpd_digest.h
+ * @brief Digests of files for HASH, XSHA256 and XCRC, cached with the
+ *        files.
+ *
+ * A file's SHA-256 and CRC-32 are computed together, in one read, and
+ * kept in an extended attribute of the file, keyed by its inode, size
+ * and modification time. A file changed since, or copied to another
+ * inode, no longer matches its key, so a stale digest is never given.
+ * Uploads can be digested as they arrive, so that checking one costs a
+ * round trip rather than a read of the file.
+ */
+
+#ifndef FTPD_DIGEST_H
+#define FTPD_DIGEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "utils/jbox_hash.h"
+
+
+/** Extended attribute holding a file's digests. */
+#define FTPD_DIGEST_XATTR "user.ftpd.digest"
+
+/** Size of a buffer for a digest in hex. */
+#define FTPD_DIGEST_HEX_MAX (2 * JBOX_SHA256_LEN + 1)
+
+
+/**
+ * @brief Digests a server reports.
+ */
+typedef enum {
+  FTPD_DIGEST_SHA256,
+  FTPD_DIGEST_CRC32,
+} ftpd_digest_kind_t;
+
+
+/**
+ * @brief Digests of data being received.
+ */
+typedef struct {
+  jbox_sha256_t sha256;
+  uint32_t crc32;
+} ftpd_digest_t;
+
+
+/**
+ * @brief Start digesting data.
+ *
+ * @param digest Digest state to initialize.
+ */
+void ftpd_digest_init(ftpd_digest_t *digest);
+
+
+/**
+ * @brief Add data to the digests.
+ *
+ * @param digest Digest state.
+ * @param data Bytes received.
+ * @param len Number of bytes.
+ */
+void ftpd_digest_update(ftpd_digest_t *digest, const void *data,
+                        size_t len);
+
+
+/**
+ * @brief Finish the digests of a whole file and cache them on it.
+ *
+ * Call once the last byte is written, since the key is the file's
+ * state at this point. A file system without user extended attributes
+ * keeps no cache, which only costs a read on the next request.
+ *
+ * @param digest Digest state of everything in the file.
+ * @param fd The file.
+ */
+void ftpd_digest_store(ftpd_digest_t *digest, int fd);
+
+
+/**
+ * @brief Get a digest of a file, from its cache if that still applies.
+ *
+ * Otherwise both digests are computed and cached.
+ *
+ * @param fd Regular file, open for reading.
+ * @param kind Digest wanted.
+ * @param hex Set to the digest in lower-case hex.
+ * @param hexsize Size of hex; FTPD_DIGEST_HEX_MAX is enough.
+ * @return 0 on success, -1 on a read error.
+ */
+int ftpd_digest_file(int fd, ftpd_digest_kind_t kind, char *hex,
+                     size_t hexsize);
+
+
+#endif /* FTPD_DIGEST_H */
@@ -0,0 +1,324 @@
+/**
+ * @file ftpd_handoff.c
+ * @brief Handing the listening sockets over to a new server
+ *        implementation.
+ *
+ * The old server sends one message: a header giving the number of
+ * sockets, with the sockets themselves attached, the loops' listeners
+ * first and the stats socket last. The new server answers with a
+ * single byte once it is running.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ftpd.h"
+#include "ftpd_handoff.h"
+#include "ftpd_stats.h"
+
+
+/** Marks a handoff message, "FTPH". */
+#define FTPD_HANDOFF_MAGIC 0x46545048u
+
+/** How long a new server waits for the old one's sockets, in seconds. */
+#define FTPD_HANDOFF_TIMEOUT 5
+
+/** Most sockets in a message: the loops' listeners and stats. */
+#define FTPD_HANDOFF_FDS (FTPD_MAX_ACCEPTORS + 1)
+
+
+/**
+ * @brief Header of the message carrying the sockets.
+ */
+typedef struct {
+  uint32_t magic;         /**< FTPD_HANDOFF_MAGIC. */
+  int32_t listeners;      /**< Listening sockets of the loops. */
+  int32_t stats;          /**< 1 if the stats socket follows, else 0. */
+} ftpd_handoff_msg_t;
+
+
+/**
+ * @brief Fill in the address of a handoff socket.
+ *
+ * @param addr Address to fill in.
+ * @param path Path of the socket.
+ * @return 0 on success, -1 if the path is too long.
+ */
+static int handoff_addr(struct sockaddr_un *addr, const char *path) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    fprintf(stderr, "ftpd: handoff path too long: %s\n", path);
+    return -1;
+  }
+  strcpy(addr->sun_path, path);
+  return 0;
+}
+
+
+/**
+ * @brief Port a listening socket is bound to.
+ *
+ * @param fd Socket.
+ * @return Port (host order), or 0 if unknown.
+ */
+static uint16_t local_port(int fd) {
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  if (getsockname(fd, (struct sockaddr *)&addr, &len) < 0 ||
+      addr.sin_family != AF_INET) {
+    return 0;
+  }
+  return ntohs(addr.sin_port);
+}
+
+
+/**
+ * @brief Close what a handoff holds.
+ *
+ * @param handoff Sockets taken over.
+ */
+static void close_handoff(ftpd_handoff_t *handoff) {
+  for (int i = 0; i < handoff->listener_count; i++) {
+    close(handoff->listeners[i]);
+  }
+  if (handoff->stats_fd >= 0) {
+    close(handoff->stats_fd);
+  }
+  if (handoff->conn >= 0) {
+    close(handoff->conn);
+  }
+  handoff->listener_count = 0;
+  handoff->stats_fd = -1;
+  handoff->conn = -1;
+}
+
+
+/**
+ * @brief Read the old server's message and the sockets attached to it.
+ *
+ * @param handoff Sockets taken over, with conn connected.
+ * @return 0 on success, -1 on error.
+ */
+static int read_sockets(ftpd_handoff_t *handoff) {
+  ftpd_handoff_msg_t msg;
+  union {
+    char buf[CMSG_SPACE(FTPD_HANDOFF_FDS * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov = { .iov_base = &msg, .iov_len = sizeof(msg) };
+  struct msghdr hdr = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control.buf,
+    .msg_controllen = sizeof(control.buf)
+  };
+
+  ssize_t n;
+  do {
+    n = recvmsg(handoff->conn, &hdr, MSG_CMSG_CLOEXEC);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0) {
+    perror("ftpd: handoff");
+    return -1;
+  }
+
+  /* Keep whatever came, so that it is closed on error */
+  int fds[FTPD_HANDOFF_FDS];
+  int count = 0;
+  for (struct cmsghdr *c = CMSG_FIRSTHDR(&hdr); c; c = CMSG_NXTHDR(&hdr, c)) {
+    if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+      int got = (int)((c->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+      for (int i = 0; i < got && count < FTPD_HANDOFF_FDS; i++) {
+        memcpy(&fds[count++], CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+      }
+    }
+  }
+
+  bool valid = n == (ssize_t)sizeof(msg) &&
+               !(hdr.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) &&
+               msg.magic == FTPD_HANDOFF_MAGIC &&
+               msg.listeners > 0 && msg.listeners <= FTPD_MAX_ACCEPTORS &&
+               (msg.stats == 0 || msg.stats == 1) &&
+               count == msg.listeners + msg.stats;
+  if (!valid) {
+    for (int i = 0; i < count; i++) {
+      close(fds[i]);
+    }
+    fprintf(stderr, "ftpd: handoff: bad message from the running server\n");
+    return -1;
+  }
+
+  memcpy(handoff->listeners, fds, (size_t)msg.listeners * sizeof(int));
+  handoff->listener_count = msg.listeners;
+  if (msg.stats) {
+    handoff->stats_fd = fds[msg.listeners];
+  }
+  return 0;
+}
+
+
+int ftpd_handoff_receive(ftpd_server_t *server, ftpd_handoff_t *handoff) {
+  memset(handoff, 0, sizeof(*handoff));
+  handoff->conn = -1;
+  handoff->stats_fd = -1;
+
+  struct sockaddr_un addr;
+  if (handoff_addr(&addr, server->config.handoff_path) < 0) {
+    return -1;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    perror("ftpd: handoff socket");
+    return -1;
+  }
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    int err = errno;
+    close(fd);
+    if (err == ENOENT || err == ECONNREFUSED) {
+      return 0;  /* No server running: start afresh */
+    }
+    fprintf(stderr, "ftpd: handoff connect: %s\n", strerror(err));
+    return -1;
+  }
+  handoff->conn = fd;
+
+  /* A server stuck in its loop does not hold this one up for good */
+  struct timeval timeout = { .tv_sec = FTPD_HANDOFF_TIMEOUT };
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  if (read_sockets(handoff) < 0) {
+    close_handoff(handoff);
+    return -1;
+  }
+
+  uint16_t port = local_port(handoff->listeners[0]);
+  if (port != server->config.port) {
+    fprintf(stderr, "ftpd: the running server listens on port %u, "
+            "not %u\n", port, server->config.port);
+    close_handoff(handoff);
+    return -1;
+  }
+
+  int optval = 0;
+  socklen_t optlen = sizeof(optval);
+  handoff->shared = getsockopt(handoff->listeners[0], SOL_SOCKET,
+                               SO_REUSEPORT, &optval, &optlen) == 0 &&
+                    optval != 0;
+
+  if (handoff->stats_fd >= 0 &&
+      local_port(handoff->stats_fd) != server->config.stats_port) {
+    close(handoff->stats_fd);
+    handoff->stats_fd = -1;
+  }
+  return 0;
+}
+
+
+void ftpd_handoff_done(ftpd_handoff_t *handoff) {
+  if (handoff->conn < 0) {
+    return;
+  }
+  static const char ready = 'R';
+  if (send(handoff->conn, &ready, 1, MSG_NOSIGNAL) != 1) {
+    perror("ftpd: handoff");
+  }
+  close(handoff->conn);
+  handoff->conn = -1;
+}
+
+
+int ftpd_handoff_listen(ftpd_server_t *server) {
+  const char *path = server->config.handoff_path;
+  char tmp[sizeof(((struct sockaddr_un *)0)->sun_path)];
+  struct sockaddr_un addr;
+  if (snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid()) >=
+      (int)sizeof(tmp) || handoff_addr(&addr, tmp) < 0) {
+    fprintf(stderr, "ftpd: handoff path too long: %s\n", path);
+    return -1;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    perror("ftpd: handoff socket");
+    return -1;
+  }
+
+  /* Bound aside and renamed into place, so the path always answers */
+  unlink(tmp);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      chmod(tmp, S_IRUSR | S_IWUSR) < 0 || listen(fd, 4) < 0 ||
+      rename(tmp, path) < 0) {
+    fprintf(stderr, "ftpd: handoff listen on %s: %s\n", path,
+            strerror(errno));
+    unlink(tmp);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+
+int ftpd_handoff_send(ftpd_server_t *server, int conn) {
+  struct ucred peer;
+  socklen_t len = sizeof(peer);
+  if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &peer, &len) < 0 ||
+      peer.uid != geteuid()) {
+    fprintf(stderr, "ftpd: handoff refused to another user\n");
+    return -1;
+  }
+
+  int fds[FTPD_HANDOFF_FDS];
+  ftpd_handoff_msg_t msg = { .magic = FTPD_HANDOFF_MAGIC };
+  for (int i = 0; i < server->loop_count; i++) {
+    if (server->loops[i].listen_fd >= 0) {
+      fds[msg.listeners++] = server->loops[i].listen_fd;
+    }
+  }
+  int stats_fd = ftpd_stats_socket(server);
+  if (stats_fd >= 0) {
+    fds[msg.listeners] = stats_fd;
+    msg.stats = 1;
+  }
+  if (msg.listeners == 0) {
+    return -1;
+  }
+
+  size_t fds_len = (size_t)(msg.listeners + msg.stats) * sizeof(int);
+  union {
+    char buf[CMSG_SPACE(FTPD_HANDOFF_FDS * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  memset(&control, 0, sizeof(control));
+  struct iovec iov = { .iov_base = &msg, .iov_len = sizeof(msg) };
+  struct msghdr hdr = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control.buf,
+    .msg_controllen = CMSG_SPACE(fds_len)
+  };
+  struct cmsghdr *c = CMSG_FIRSTHDR(&hdr);
+  c->cmsg_level = SOL_SOCKET;
+  c->cmsg_type = SCM_RIGHTS;
+  c->cmsg_len = CMSG_LEN(fds_len);
+  memcpy(CMSG_DATA(c), fds, fds_len);
+
+  if (sendmsg(conn, &hdr, MSG_NOSIGNAL) != (ssize_t)sizeof(msg)) {
+    perror("ftpd: handoff send");
+    return -1;
+  }
+  printf("ftpd: sent %d listening sockets to pid %d\n",
+         msg.listeners + msg.stats, (int)peer.pid);
+  return 0;
+}
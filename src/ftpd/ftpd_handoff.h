@@ -0,0 +1,87 @@
+/**
+ * @file ftpd_handoff.h
+ * @brief Handing the listening sockets over to a new server.
+ *
+ * A server started with config.handoff_path listens on a Unix socket
+ * there. A new server started with the same path, to take up a new
+ * binary or configuration, connects to it first and is sent the old
+ * one's listening sockets with SCM_RIGHTS: those of its event loops and
+ * its stats endpoint. The sockets stay open throughout, so connections
+ * that arrive meanwhile wait in their backlog rather than being
+ * refused. Once running, the new server tells the old one, which stops
+ * accepting and serves its sessions until they end or the drain timeout
+ * passes.
+ *
+ * Should the new server fail before it is running, the old one never
+ * hears from it and goes on as before.
+ */
+
+#ifndef FTPD_HANDOFF_H
+#define FTPD_HANDOFF_H
+
+#include "ftpd.h"
+
+
+/**
+ * @brief Sockets taken over from a running server.
+ */
+typedef struct ftpd_handoff {
+  int conn;                             /**< Connection to the old server,
+                                             or -1 if none was running. */
+  int listeners[FTPD_MAX_ACCEPTORS];    /**< Its listening sockets. */
+  int listener_count;                   /**< Sockets in listeners. */
+  bool shared;                          /**< Whether they were bound with
+                                             SO_REUSEPORT, so more may
+                                             join them. */
+  int stats_fd;                         /**< Its stats socket, or -1. */
+} ftpd_handoff_t;
+
+
+/**
+ * @brief Take the listening sockets of the server at config.handoff_path,
+ *        if one is running there.
+ *
+ * A stats socket on another port than config.stats_port is closed.
+ *
+ * @param server Pointer to initialized server.
+ * @param handoff Set to the sockets taken over; conn is -1 and there are
+ *        none if no server answered.
+ * @return 0 on success, -1 if the running server's sockets cannot be
+ *         taken over.
+ */
+int ftpd_handoff_receive(ftpd_server_t *server, ftpd_handoff_t *handoff);
+
+
+/**
+ * @brief Tell the old server that the new one is running, so that it
+ *        stops accepting, and close the connection to it.
+ *
+ * @param handoff Sockets taken over; conn may be -1.
+ */
+void ftpd_handoff_done(ftpd_handoff_t *handoff);
+
+
+/**
+ * @brief Listen for the next server on config.handoff_path, replacing
+ *        what is there.
+ *
+ * @param server Pointer to server structure.
+ * @return Non-blocking listening socket, or -1 on error.
+ */
+int ftpd_handoff_listen(ftpd_server_t *server);
+
+
+/**
+ * @brief Send a server's listening sockets to a new server connected to
+ *        its handoff socket.
+ *
+ * The sockets are refused to a peer of another user than the server's.
+ *
+ * @param server Pointer to running server.
+ * @param conn Accepted connection.
+ * @return 0 if sent, -1 if not.
+ */
+int ftpd_handoff_send(ftpd_server_t *server, int conn);
+
+
+#endif /* FTPD_HANDOFF_H */
@@ -6,6 +6,8 @@
  * daemon. It parses command-line arguments and starts the server.
  */
 
+#include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -47,6 +49,37 @@ static void print_usage(const char *progname, void **argtable) {
 }
 
 
+/**
+ * @brief Parse a byte count with an optional K, M or G suffix.
+ *
+ * @param text Text to parse.
+ * @param bytes Set to the count.
+ * @return 0 on success, -1 if text is not a count.
+ */
+static int parse_size(const char *text, uint64_t *bytes) {
+  char *end;
+  errno = 0;
+  unsigned long long value = strtoull(text, &end, 10);
+  if (errno != 0 || end == text || *text == '-') {
+    return -1;
+  }
+
+  unsigned int shift = 0;
+  switch (toupper((unsigned char)*end)) {
+    case 'K': shift = 10; end++; break;
+    case 'M': shift = 20; end++; break;
+    case 'G': shift = 30; end++; break;
+    default: break;
+  }
+  if (*end != '\0' || value > (UINT64_MAX >> shift)) {
+    return -1;
+  }
+
+  *bytes = (uint64_t)value << shift;
+  return 0;
+}
+
+
 /**
  * @brief Main entry point for the FTP server.
  *
@@ -61,9 +94,64 @@ int main(int argc, char **argv) {
                                   "port to listen on (default: 21021)");
   struct arg_str *root = arg_str0("r", "root", "<dir>",
                                   "root directory (default: srv/ftp)");
+  struct arg_str *pasv_ports = arg_str0(NULL, "pasv-ports", "<min-max>",
+                                        "passive data port range "
+                                        "(default: any)");
+  struct arg_str *pasv_addr = arg_str0(NULL, "pasv-address", "<ip>",
+                                       "address given in PASV replies "
+                                       "(default: the client's view)");
+  struct arg_str *rate = arg_str0(NULL, "rate-limit", "<bytes/s>",
+                                  "transfer rate per client, K, M or G "
+                                  "suffix allowed (default: none)");
+  struct arg_str *total_rate = arg_str0(NULL, "total-rate-limit",
+                                        "<bytes/s>",
+                                        "transfer rate of all clients "
+                                        "together (default: none)");
+  struct arg_int *max_transfers = arg_int0(NULL, "max-transfers", "<n>",
+                                           "transfers at once (default: 8)");
+  struct arg_str *small_file = arg_str0(NULL, "small-file", "<bytes>",
+                                        "largest download served ahead "
+                                        "of bulk ones, 0 for none "
+                                        "(default: 1M)");
+  struct arg_str *cache_size = arg_str0(NULL, "cache-size", "<bytes>",
+                                       "memory for small files many "
+                                       "clients download, 0 for none "
+                                       "(default: 64M)");
+  struct arg_int *stats_port = arg_int0(NULL, "stats-port", "<port>",
+                                        "serve /metrics and /stats on "
+                                        "127.0.0.1 (default: off)");
+  struct arg_str *tls_cert = arg_str0(NULL, "tls-cert", "<file>",
+                                      "PEM certificate chain; enables "
+                                      "AUTH TLS (default: off)");
+  struct arg_str *tls_key = arg_str0(NULL, "tls-key", "<file>",
+                                     "PEM private key (default: in the "
+                                     "certificate file)");
+  struct arg_lit *fsync_uploads = arg_lit0(NULL, "fsync",
+                                           "flush uploads to disk before "
+                                           "confirming them");
+  struct arg_lit *digest_uploads = arg_lit0(NULL, "digest-uploads",
+                                            "digest uploads as they arrive, "
+                                            "for HASH and XCRC");
+  struct arg_int *acceptors = arg_int0(NULL, "acceptors", "<n>",
+                                       "event loops accepting connections, "
+                                       "each pinned to a CPU, 0 for one "
+                                       "per CPU (default: 1)");
+  struct arg_str *handoff = arg_str0(NULL, "handoff", "<path>",
+                                     "Unix socket to take the listeners "
+                                     "of a running server from and hand "
+                                     "them on (default: none)");
+  struct arg_int *drain_timeout = arg_int0(NULL, "drain-timeout",
+                                           "<seconds>",
+                                           "how long a replaced server "
+                                           "serves its sessions "
+                                           "(default: 300)");
   struct arg_end *end = arg_end(20);
 
-  void *argtable[] = {help, port, root, end};
+  void *argtable[] = {help, port, root, pasv_ports, pasv_addr, rate,
+                      total_rate, max_transfers, small_file, cache_size,
+                      stats_port, tls_cert, tls_key, fsync_uploads,
+                      digest_uploads, acceptors, handoff, drain_timeout,
+                      end};
 
   /* Set defaults */
   port->ival[0] = FTPD_DEFAULT_PORT;
@@ -98,11 +186,114 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  /* Get passive port range */
+  unsigned int pasv_min = 0, pasv_max = 0;
+  if (pasv_ports->count > 0) {
+    char extra;
+    if (sscanf(pasv_ports->sval[0], "%u-%u%c",
+               &pasv_min, &pasv_max, &extra) != 2 ||
+        pasv_min < 1024 || pasv_max > 65535 || pasv_min > pasv_max) {
+      fprintf(stderr, "ftpd: invalid passive port range: %s\n",
+              pasv_ports->sval[0]);
+      arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+      return 1;
+    }
+  }
+
+  /* Get transfer limits */
+  uint64_t rate_limit = 0, total_rate_limit = 0, small_bytes = 0;
+  uint64_t cache_bytes = 0;
+  const char *bad_size = NULL;
+  if (rate->count > 0 && parse_size(rate->sval[0], &rate_limit) < 0) {
+    bad_size = rate->sval[0];
+  } else if (total_rate->count > 0 &&
+             parse_size(total_rate->sval[0], &total_rate_limit) < 0) {
+    bad_size = total_rate->sval[0];
+  } else if (small_file->count > 0 &&
+             (parse_size(small_file->sval[0], &small_bytes) < 0 ||
+              small_bytes > INT64_MAX)) {
+    bad_size = small_file->sval[0];
+  } else if (cache_size->count > 0 &&
+             (parse_size(cache_size->sval[0], &cache_bytes) < 0 ||
+              cache_bytes > INT64_MAX)) {
+    bad_size = cache_size->sval[0];
+  }
+  if (bad_size) {
+    fprintf(stderr, "ftpd: invalid byte count: %s\n", bad_size);
+    arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+    return 1;
+  }
+  if (max_transfers->count > 0 &&
+      (max_transfers->ival[0] < 1 ||
+       max_transfers->ival[0] > FTPD_MAX_WORKERS)) {
+    fprintf(stderr, "ftpd: max transfers must be 1 to %d\n",
+            FTPD_MAX_WORKERS);
+    arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+    return 1;
+  }
+
+  int loops = acceptors->count > 0 ? acceptors->ival[0] : 1;
+  if (loops < 0 || loops > FTPD_MAX_ACCEPTORS) {
+    fprintf(stderr, "ftpd: acceptors must be 0 to %d\n", FTPD_MAX_ACCEPTORS);
+    arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+    return 1;
+  }
+  if (loops == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    loops = cpus < 1 ? 1 : cpus > FTPD_MAX_ACCEPTORS ? FTPD_MAX_ACCEPTORS
+                                                     : (int)cpus;
+  }
+
+  int stats = stats_port->count > 0 ? stats_port->ival[0] : 0;
+  if (stats < 0 || stats > 65535) {
+    fprintf(stderr, "ftpd: invalid stats port: %d\n", stats);
+    arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+    return 1;
+  }
+
+  int drain = drain_timeout->count > 0 ? drain_timeout->ival[0] : 0;
+  if (drain_timeout->count > 0 && drain < 1) {
+    fprintf(stderr, "ftpd: drain timeout must be at least 1 second\n");
+    arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+    return 1;
+  }
+
+  if (tls_key->count > 0 && tls_cert->count == 0) {
+    fprintf(stderr, "ftpd: --tls-key needs --tls-cert\n");
+    arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+    return 1;
+  }
+
+  off_t small_limit = 0;
+  if (small_file->count > 0) {
+    small_limit = small_bytes > 0 ? (off_t)small_bytes : -1;
+  }
+  off_t cache_limit = 0;
+  if (cache_size->count > 0) {
+    cache_limit = cache_bytes > 0 ? (off_t)cache_bytes : -1;
+  }
+
   /* Configure server */
   ftpd_config_t config = {
     .port = (uint16_t)listen_port,
     .root_dir = root_dir,
-    .max_clients = FTPD_MAX_CLIENTS
+    .max_clients = FTPD_MAX_CLIENTS,
+    .pasv_min_port = (uint16_t)pasv_min,
+    .pasv_max_port = (uint16_t)pasv_max,
+    .pasv_address = pasv_addr->count > 0 ? pasv_addr->sval[0] : NULL,
+    .rate_limit = rate_limit,
+    .total_rate_limit = total_rate_limit,
+    .max_transfers = max_transfers->count > 0 ? max_transfers->ival[0] : 0,
+    .small_file = small_limit,
+    .cache_size = cache_limit,
+    .stats_port = (uint16_t)stats,
+    .tls_cert = tls_cert->count > 0 ? tls_cert->sval[0] : NULL,
+    .tls_key = tls_key->count > 0 ? tls_key->sval[0] : NULL,
+    .fsync_uploads = fsync_uploads->count > 0,
+    .digest_uploads = digest_uploads->count > 0,
+    .acceptors = loops,
+    .handoff_path = handoff->count > 0 ? handoff->sval[0] : NULL,
+    .drain_timeout = drain
   };
 
   /* Initialize server */
@@ -2,178 +2,289 @@
  * @file ftpd_path.c
  * @brief FTP path resolution and security implementation.
  *
- * This module provides secure path resolution to prevent directory
- * traversal attacks. All paths are validated to ensure they remain
- * within the server root directory.
+ * This module opens the paths clients name with openat2() and
+ * RESOLVE_BENEATH, so that the kernel keeps every lookup, symlinks
+ * included, within the server root. Lookups start from the session's
+ * current directory when the path cannot climb out of it, which saves
+ * walking the directories above it again.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/stat.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
 
 #include "ftpd.h"
 #include "ftpd_path.h"
 
 
-char *ftpd_path_join(const char *base, const char *name,
-                     char *buf, size_t bufsize) {
-  if (!base || !name || !buf || bufsize == 0) {
-    return NULL;
-  }
+/** Tries of a lookup the kernel abandoned for a concurrent rename. */
+#define FTPD_PATH_RETRIES 4
 
-  size_t base_len = strlen(base);
-  size_t name_len = strlen(name);
 
-  /* Check if we need a separator */
-  int need_sep = (base_len > 0 && base[base_len - 1] != '/') ? 1 : 0;
+int ftpd_path_open_beneath(int dirfd, const char *path, int flags,
+                           mode_t mode) {
+  struct open_how how = {
+    .flags = (uint64_t)(flags | O_CLOEXEC),
+    .mode = (flags & O_CREAT) ? mode : 0,
+    .resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS
+  };
 
-  /* Check total length */
-  if (base_len + need_sep + name_len >= bufsize) {
-    return NULL;
+  for (int i = 0; i < FTPD_PATH_RETRIES; i++) {
+    long fd = syscall(SYS_openat2, dirfd, path, &how, sizeof(how));
+    if (fd >= 0 || errno != EAGAIN) {
+      return (int)fd;
+    }
   }
+  return -1;
+}
 
-  /* Build the path */
-  strcpy(buf, base);
-  if (need_sep) {
-    buf[base_len] = '/';
-    strcpy(buf + base_len + 1, name);
-  } else {
-    strcpy(buf + base_len, name);
-  }
 
-  return buf;
+/**
+ * @brief Whether a path has a ".." component.
+ *
+ * @param path Path to check.
+ * @return true if it has one.
+ */
+static bool has_dotdot(const char *path) {
+  const char *p = path;
+  while (*p) {
+    const char *end = strchrnul(p, '/');
+    if (end - p == 2 && p[0] == '.' && p[1] == '.') {
+      return true;
+    }
+    p = *end ? end + 1 : end;
+  }
+  return false;
 }
 
 
-bool ftpd_path_is_safe(const char *path, const char *server_root) {
-  if (!path || !server_root) {
-    return false;
+/**
+ * @brief Make a client's path relative to the root.
+ *
+ * @param client Pointer to client structure (for cwd).
+ * @param path Path named by the client.
+ * @param buf Buffer for the result.
+ * @param bufsize Size of buf.
+ * @return The path, "." for the root, or NULL if buf is too small.
+ */
+static const char *root_relative(ftpd_client_t *client, const char *path,
+                                 char *buf, size_t bufsize) {
+  /* cwd always starts with the "/" of the root */
+  const char *base = path[0] == '/' ? "" : client->cwd + 1;
+  path += strspn(path, "/");
+
+  int len = snprintf(buf, bufsize, "%s%s%s", base,
+                     base[0] && path[0] ? "/" : "", path);
+  if (len < 0 || (size_t)len >= bufsize) {
+    errno = ENAMETOOLONG;
+    return NULL;
   }
+  return buf[0] ? buf : ".";
+}
 
-  size_t root_len = strlen(server_root);
 
-  /* Path must start with server_root */
-  if (strncmp(path, server_root, root_len) != 0) {
-    return false;
+int ftpd_path_open(ftpd_client_t *client, const char *path, int flags,
+                   mode_t mode) {
+  ftpd_server_t *server = client->server;
+  if (!path || path[0] == '\0') {
+    path = ".";
   }
 
-  /* If path is exactly server_root, it's safe */
-  if (path[root_len] == '\0') {
-    return true;
+  int cwd_fd = client->cwd_fd >= 0 ? client->cwd_fd : server->root_fd;
+  if (path[0] != '/' && !has_dotdot(path)) {
+    int fd = ftpd_path_open_beneath(cwd_fd, path, flags, mode);
+    /* A symlink may climb out of the cwd yet stay within the root */
+    if (fd >= 0 || errno != EXDEV || cwd_fd == server->root_fd) {
+      return fd;
+    }
   }
 
-  /* Path must have a separator after server_root */
-  if (path[root_len] != '/') {
-    return false;
+  char rel[PATH_MAX];
+  const char *from_root = root_relative(client, path, rel, sizeof(rel));
+  if (!from_root) {
+    return -1;
   }
-
-  return true;
+  return ftpd_path_open_beneath(server->root_fd, from_root, flags, mode);
 }
 
 
-char *ftpd_resolve_path(ftpd_client_t *client, const char *path,
-                        const char *server_root) {
-  if (!client || !server_root) {
-    return NULL;
+int ftpd_path_stat(ftpd_client_t *client, const char *path,
+                   struct stat *st) {
+  int fd = ftpd_path_open(client, path, O_PATH, 0);
+  if (fd < 0) {
+    return -1;
   }
+  int rc = fstat(fd, st);
+  close(fd);
+  return rc;
+}
 
-  char workpath[PATH_MAX];
 
-  if (!path || path[0] == '\0') {
-    /* Use current working directory */
-    strncpy(workpath, client->cwd, sizeof(workpath) - 1);
-    workpath[sizeof(workpath) - 1] = '\0';
-  } else if (path[0] == '/') {
-    /* Absolute path - relative to server root */
-    if (snprintf(workpath, sizeof(workpath), "%s%s",
-                 server_root, path) >= (int)sizeof(workpath)) {
-      return NULL;
-    }
-  } else {
-    /* Relative path - relative to cwd */
-    if (ftpd_path_join(client->cwd, path, workpath, sizeof(workpath)) == NULL) {
-      return NULL;
-    }
+int ftpd_path_parent(ftpd_client_t *client, const char *path,
+                     char *name, size_t namesize) {
+  if (!path) {
+    errno = EINVAL;
+    return -1;
   }
 
-  /* Resolve to canonical path */
-  char *resolved = realpath(workpath, NULL);
-
-  /* If file doesn't exist, realpath fails. Try parent directory. */
-  if (!resolved) {
-    /* For non-existent files, construct the path manually */
-    /* Find the last component */
-    char *last_slash = strrchr(workpath, '/');
-    if (last_slash && last_slash != workpath) {
-      *last_slash = '\0';
-      char *parent = realpath(workpath, NULL);
-      if (parent) {
-        /* Reconstruct with resolved parent */
-        size_t plen = strlen(parent);
-        size_t nlen = strlen(last_slash + 1);
-        resolved = malloc(plen + 1 + nlen + 1);
-        if (resolved) {
-          sprintf(resolved, "%s/%s", parent, last_slash + 1);
-        }
-        free(parent);
-      }
-    }
+  /* Trailing slashes do not make another component */
+  char dir[PATH_MAX];
+  size_t len = strlen(path);
+  while (len > 1 && path[len - 1] == '/') {
+    len--;
   }
+  if (len >= sizeof(dir)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  memcpy(dir, path, len);
+  dir[len] = '\0';
+
+  char *slash = strrchr(dir, '/');
+  const char *leaf = slash ? slash + 1 : dir;
+  if (leaf[0] == '\0' || strcmp(leaf, ".") == 0 || strcmp(leaf, "..") == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (strlen(leaf) >= namesize) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(name, leaf);
+
+  const char *parent = NULL;
+  if (slash == dir) {
+    parent = "/";
+  } else if (slash) {
+    *slash = '\0';
+    parent = dir;
+  }
+  return ftpd_path_open(client, parent, O_PATH | O_DIRECTORY, 0);
+}
 
-  if (!resolved) {
-    return NULL;
+
+/**
+ * @brief Get the path of an open directory below the root, as the
+ *        kernel sees it.
+ *
+ * @param server Pointer to server structure.
+ * @param fd Descriptor of the directory.
+ * @param buf Buffer for the path.
+ * @param bufsize Size of buf.
+ * @return 0 on success, -1 if the path is unknown.
+ */
+static int real_display(ftpd_server_t *server, int fd, char *buf,
+                        size_t bufsize) {
+  char link[64], real[PATH_MAX];
+  snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+  ssize_t len = readlink(link, real, sizeof(real) - 1);
+  if (len <= 0) {
+    return -1;
   }
+  real[len] = '\0';
 
-  /* Verify path is within server root */
-  if (!ftpd_path_is_safe(resolved, server_root)) {
-    free(resolved);
-    return NULL;
+  /* A root of "/" is a prefix of everything */
+  size_t root_len = strlen(server->root_realpath);
+  if (root_len == 1) {
+    root_len = 0;
+  }
+  if (strncmp(real, server->root_realpath, root_len) != 0 ||
+      (real[root_len] != '\0' && real[root_len] != '/')) {
+    return -1;
   }
 
-  return resolved;
+  const char *rest = real[root_len] ? real + root_len : "/";
+  if (strlen(rest) >= bufsize) {
+    return -1;
+  }
+  strcpy(buf, rest);
+  return 0;
 }
 
 
-char *ftpd_path_to_display(const char *abspath, const char *server_root,
-                           char *buf, size_t bufsize) {
-  if (!abspath || !server_root || !buf || bufsize == 0) {
-    return NULL;
+int ftpd_path_chdir(ftpd_client_t *client, const char *path) {
+  int fd = ftpd_path_open(client, path, O_PATH | O_DIRECTORY, 0);
+  if (fd < 0) {
+    return -1;
   }
 
-  size_t root_len = strlen(server_root);
+  char display[PATH_MAX];
+  if (real_display(client->server, fd, display, sizeof(display)) < 0 &&
+      !ftpd_path_display(client, path, display, sizeof(display))) {
+    close(fd);
+    errno = ENAMETOOLONG;
+    return -1;
+  }
 
-  /* Path must start with server_root */
-  if (strncmp(abspath, server_root, root_len) != 0) {
-    return NULL;
+  /* The root needs no descriptor of its own */
+  if (strcmp(display, "/") == 0) {
+    close(fd);
+    fd = -1;
   }
+  if (client->cwd_fd >= 0) {
+    close(client->cwd_fd);
+  }
+  client->cwd_fd = fd;
+  strcpy(client->cwd, display);
+  return 0;
+}
 
-  const char *relpath = abspath + root_len;
 
-  /* Handle root directory */
-  if (relpath[0] == '\0') {
-    if (bufsize < 2) {
-      return NULL;
-    }
-    buf[0] = '/';
-    buf[1] = '\0';
-    return buf;
+void ftpd_path_chroot(ftpd_client_t *client) {
+  if (client->cwd_fd >= 0) {
+    close(client->cwd_fd);
+    client->cwd_fd = -1;
   }
+  strcpy(client->cwd, "/");
+}
 
-  /* Copy the relative path (should start with /) */
-  if (relpath[0] != '/') {
-    /* Shouldn't happen, but handle it */
-    if (snprintf(buf, bufsize, "/%s", relpath) >= (int)bufsize) {
-      return NULL;
+
+char *ftpd_path_display(ftpd_client_t *client, const char *path,
+                        char *buf, size_t bufsize) {
+  if (!path) {
+    path = "";
+  }
+
+  char joined[PATH_MAX];
+  int n = snprintf(joined, sizeof(joined), "%s/%s",
+                   path[0] == '/' ? "" : client->cwd, path);
+  if (n < 0 || (size_t)n >= sizeof(joined) || bufsize < 2) {
+    return NULL;
+  }
+
+  /* Copy the components, dropping "." and backing up over ".." */
+  size_t len = 0;
+  char *save;
+  for (char *comp = strtok_r(joined, "/", &save); comp;
+       comp = strtok_r(NULL, "/", &save)) {
+    if (strcmp(comp, ".") == 0) {
+      continue;
     }
-  } else {
-    if (strlen(relpath) >= bufsize) {
+    if (strcmp(comp, "..") == 0) {
+      while (len > 0 && buf[--len] != '/') {
+      }
+      continue;
+    }
+    size_t clen = strlen(comp);
+    if (len + 1 + clen >= bufsize) {
       return NULL;
     }
-    strcpy(buf, relpath);
+    buf[len++] = '/';
+    memcpy(buf + len, comp, clen);
+    len += clen;
   }
 
+  if (len == 0) {
+    buf[len++] = '/';
+  }
+  buf[len] = '\0';
   return buf;
 }
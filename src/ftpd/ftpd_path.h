@@ -2,78 +2,123 @@
  * @file ftpd_path.h
  * @brief FTP path resolution and security.
  *
- * This module provides secure path resolution to prevent
- * directory traversal attacks. All paths are resolved relative
- * to the server root and validated to ensure they don't escape.
+ * This module resolves the paths clients name without letting them
+ * escape the server root. Files are opened with openat2() and
+ * RESOLVE_BENEATH relative to a descriptor of the root, or of the
+ * session's current directory, so the kernel refuses any "..", or
+ * symlink, that leads out of it while resolving. Nothing is resolved
+ * to a string first, and a symlink swapped in between a check and the
+ * open cannot lead outside, because there is no separate check.
+ *
+ * Paths shown to clients, such as the current directory, are relative
+ * to the root, which is "/".
  */
 
 #ifndef FTPD_PATH_H
 #define FTPD_PATH_H
 
+#include <sys/stat.h>
+#include <sys/types.h>
+
 #include "ftpd.h"
 
 
 /**
- * @brief Resolve a path securely within the server root.
+ * @brief Open a directory beneath another, for the server root.
+ *
+ * Fails with ENOSYS on kernels without openat2() (before Linux 5.6).
  *
- * Takes a path (absolute or relative) and resolves it to an
- * absolute path within the server root. If the path would
- * escape the server root (e.g., via ".."), returns NULL.
+ * @param dirfd Directory to resolve from.
+ * @param path Path relative to dirfd; "." for dirfd itself.
+ * @param flags open() flags; O_CLOEXEC is added.
+ * @param mode Mode of a file created with O_CREAT.
+ * @return Descriptor, or -1 with errno set.
+ */
+int ftpd_path_open_beneath(int dirfd, const char *path, int flags,
+                           mode_t mode);
+
+
+/**
+ * @brief Open a path named by a client.
  *
- * The returned path is always canonical (no "." or ".." components).
+ * A relative path without ".." is resolved from the current
+ * directory's descriptor; anything else is joined to the current
+ * directory and resolved from the root.
  *
  * @param client Pointer to client structure (for cwd).
- * @param path Path to resolve (may be NULL for cwd).
- * @param server_root Absolute path to server root directory.
- * @return Allocated canonical path string, or NULL if invalid.
- *         Caller must free the returned string.
+ * @param path Path to open, absolute meaning from the root; NULL or ""
+ *        for the current directory.
+ * @param flags open() flags; O_CLOEXEC is added.
+ * @param mode Mode of a file created with O_CREAT.
+ * @return Descriptor, or -1 with errno set (EXDEV for a path leading
+ *         out of the root).
  */
-char *ftpd_resolve_path(ftpd_client_t *client, const char *path,
-                        const char *server_root);
+int ftpd_path_open(ftpd_client_t *client, const char *path, int flags,
+                   mode_t mode);
 
 
 /**
- * @brief Check if a path is within the server root.
+ * @brief Stat a path named by a client, following symlinks beneath the
+ *        root.
  *
- * Verifies that the given absolute path is a child of
- * (or equal to) the server root directory.
+ * @param client Pointer to client structure.
+ * @param path Path, as for ftpd_path_open().
+ * @param st Set to the file's status.
+ * @return 0 on success, -1 with errno set.
+ */
+int ftpd_path_stat(ftpd_client_t *client, const char *path,
+                   struct stat *st);
+
+
+/**
+ * @brief Open the directory that would hold a path named by a client.
  *
- * @param path Absolute path to check.
- * @param server_root Absolute path to server root.
- * @return true if path is within root, false otherwise.
+ * @param client Pointer to client structure.
+ * @param path Path whose last component is to be created.
+ * @param name Buffer receiving the last component.
+ * @param namesize Size of name.
+ * @return Descriptor of the parent directory, or -1 with errno set
+ *         (EINVAL if the last component is missing, "." or "..").
  */
-bool ftpd_path_is_safe(const char *path, const char *server_root);
+int ftpd_path_parent(ftpd_client_t *client, const char *path,
+                     char *name, size_t namesize);
 
 
 /**
- * @brief Get the display path for a file.
+ * @brief Make a path named by a client the current directory.
  *
- * Converts an absolute path to a path relative to the server root
- * for display to the client. The server root is represented as "/".
+ * client->cwd becomes the directory's path below the root with
+ * symlinks resolved, as the kernel sees it.
  *
- * @param abspath Absolute path to convert.
- * @param server_root Server root directory path.
- * @param buf Buffer to store the display path.
- * @param bufsize Size of the buffer.
- * @return Pointer to buf on success, NULL on error.
+ * @param client Pointer to client structure.
+ * @param path Path of the directory.
+ * @return 0 on success, -1 with errno set (ENOTDIR if not a directory).
+ */
+int ftpd_path_chdir(ftpd_client_t *client, const char *path);
+
+
+/**
+ * @brief Make the root the current directory.
+ *
+ * @param client Pointer to client structure.
  */
-char *ftpd_path_to_display(const char *abspath, const char *server_root,
-                           char *buf, size_t bufsize);
+void ftpd_path_chroot(ftpd_client_t *client);
 
 
 /**
- * @brief Join two path components.
+ * @brief Get the display path of a path named by a client.
  *
- * Concatenates two path components with a "/" separator.
+ * The path is joined to the current directory and "." and ".."
+ * removed, without looking at the file system.
  *
- * @param base Base path.
- * @param name Name to append.
- * @param buf Buffer to store result.
- * @param bufsize Size of buffer.
- * @return Pointer to buf on success, NULL if buffer too small.
+ * @param client Pointer to client structure.
+ * @param path Path, as for ftpd_path_open().
+ * @param buf Buffer to store the display path.
+ * @param bufsize Size of the buffer.
+ * @return Pointer to buf on success, NULL if it is too small.
  */
-char *ftpd_path_join(const char *base, const char *name,
-                     char *buf, size_t bufsize);
+char *ftpd_path_display(ftpd_client_t *client, const char *path,
+                        char *buf, size_t bufsize);
 
 
 #endif /* FTPD_PATH_H */
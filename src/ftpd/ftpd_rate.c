@@ -0,0 +1,57 @@
+/**
+ * @file ftpd_rate.c
+ * @brief Token buckets limiting the rate of data transfers.
+ */
+
+#include <stdbool.h>
+
+#include "ftpd_rate.h"
+
+
+void ftpd_bucket_init(ftpd_bucket_t *bucket, uint64_t rate) {
+  pthread_mutex_init(&bucket->lock, NULL);
+  bucket->rate = (double)rate;
+  bucket->burst = bucket->rate / 10;
+  if (bucket->burst < FTPD_RATE_MIN_BURST) {
+    bucket->burst = FTPD_RATE_MIN_BURST;
+  }
+  bucket->tokens = bucket->burst;
+  clock_gettime(CLOCK_MONOTONIC, &bucket->stamp);
+}
+
+
+void ftpd_bucket_destroy(ftpd_bucket_t *bucket) {
+  pthread_mutex_destroy(&bucket->lock);
+}
+
+
+size_t ftpd_bucket_chunk(const ftpd_bucket_t *bucket, size_t max) {
+  if (!ftpd_bucket_limited(bucket) || bucket->burst >= (double)max) {
+    return max;
+  }
+  return (size_t)bucket->burst;
+}
+
+
+double ftpd_bucket_charge(ftpd_bucket_t *bucket, size_t bytes) {
+  if (!ftpd_bucket_limited(bucket)) {
+    return 0;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  pthread_mutex_lock(&bucket->lock);
+  double elapsed = (double)(now.tv_sec - bucket->stamp.tv_sec) +
+                   (double)(now.tv_nsec - bucket->stamp.tv_nsec) / 1e9;
+  bucket->stamp = now;
+  bucket->tokens += elapsed * bucket->rate;
+  if (bucket->tokens > bucket->burst) {
+    bucket->tokens = bucket->burst;
+  }
+  bucket->tokens -= (double)bytes;
+  double wait = bucket->tokens < 0 ? -bucket->tokens / bucket->rate : 0;
+  pthread_mutex_unlock(&bucket->lock);
+
+  return wait;
+}
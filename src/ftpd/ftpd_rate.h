@@ -0,0 +1,88 @@
+/**
+ * @file ftpd_rate.h
+ * @brief Token buckets limiting the rate of data transfers.
+ *
+ * A bucket fills at its rate up to a burst of a tenth of a second's
+ * worth. Bytes moved are charged to it after the fact and may take it
+ * below empty; the transfer then waits until the debt is paid. Charging
+ * a client's bucket and the server's together and waiting for the
+ * longer of the two keeps each client under its own limit and all of
+ * them under the total.
+ */
+
+#ifndef FTPD_RATE_H
+#define FTPD_RATE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+
+/** Smallest burst, so that slow limits do not mean tiny writes. */
+#define FTPD_RATE_MIN_BURST 4096
+
+
+/**
+ * @brief Token bucket.
+ */
+typedef struct ftpd_bucket {
+  pthread_mutex_t lock;     /**< Guards the rest. */
+  double rate;              /**< Bytes per second; 0 for no limit. */
+  double burst;             /**< Most bytes saved up. */
+  double tokens;            /**< Bytes that may go now; below 0 is debt. */
+  struct timespec stamp;    /**< When tokens was last brought up to date. */
+} ftpd_bucket_t;
+
+
+/**
+ * @brief Initialize a full bucket.
+ *
+ * @param bucket Bucket to initialize.
+ * @param rate Bytes per second; 0 for no limit.
+ */
+void ftpd_bucket_init(ftpd_bucket_t *bucket, uint64_t rate);
+
+
+/**
+ * @brief Release a bucket.
+ *
+ * @param bucket Bucket to release.
+ */
+void ftpd_bucket_destroy(ftpd_bucket_t *bucket);
+
+
+/**
+ * @brief Whether a bucket limits anything.
+ *
+ * @param bucket Bucket.
+ * @return true if it has a rate.
+ */
+static inline bool ftpd_bucket_limited(const ftpd_bucket_t *bucket) {
+  return bucket->rate > 0;
+}
+
+
+/**
+ * @brief Bytes to move at once under a bucket's limit.
+ *
+ * @param bucket Bucket.
+ * @param max Size of a transfer step without a limit.
+ * @return The burst of the bucket, or max if that is smaller or there
+ *         is no limit.
+ */
+size_t ftpd_bucket_chunk(const ftpd_bucket_t *bucket, size_t max);
+
+
+/**
+ * @brief Charge bytes moved to a bucket.
+ *
+ * @param bucket Bucket; one without a limit is not touched.
+ * @param bytes Bytes moved.
+ * @return Seconds to wait before moving more.
+ */
+double ftpd_bucket_charge(ftpd_bucket_t *bucket, size_t bytes);
+
+
+#endif /* FTPD_RATE_H */
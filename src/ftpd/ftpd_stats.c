@@ -0,0 +1,776 @@
+/**
+ * @file ftpd_stats.c
+ * @brief Server counters and histograms, and the stats endpoint.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <stdalign.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ftpd_stats.h"
+#include "ftpd_client.h"
+
+
+/** Blocks of counters: one shared, then one per attached thread. */
+#define FTPD_STATS_SLOTS (FTPD_MAX_WORKERS + FTPD_MAX_ACCEPTORS + 2)
+
+/** Histogram buckets; the last has no upper bound. */
+#define FTPD_STATS_BUCKETS 8
+
+/** Error reply codes counted, from 400. */
+#define FTPD_STATS_CODES 200
+
+/** Longest stats request read. */
+#define FTPD_STATS_REQUEST 1024
+
+/** How long a stats client may take to send its request. */
+#define FTPD_STATS_TIMEOUT_MS 1000
+
+/** Upper bounds of the histogram buckets, in microseconds. */
+static const uint64_t bucket_bounds[FTPD_STATS_BUCKETS - 1] = {
+  100, 1000, 10000, 100000, 1000000, 10000000, 60000000
+};
+
+/** Labels of the histogram buckets, in seconds. */
+static const char *const bucket_labels[FTPD_STATS_BUCKETS] = {
+  "0.0001", "0.001", "0.01", "0.1", "1", "10", "60", "+Inf"
+};
+
+/** Names of the timers. */
+static const char *const timer_names[FTPD_TIMERS] = {
+  "upload", "download", "queue_wait"
+};
+
+
+/**
+ * @brief Histogram; buckets are not cumulative until formatted.
+ */
+typedef struct {
+  atomic_uint_least64_t buckets[FTPD_STATS_BUCKETS];
+  atomic_uint_least64_t sum_us;
+} ftpd_histogram_t;
+
+
+/**
+ * @brief Counters written by one thread, on cache lines of their own.
+ */
+typedef struct {
+  alignas(64) atomic_uint_least64_t counters[FTPD_COUNTERS];
+  ftpd_histogram_t commands[FTPD_STATS_COMMANDS];
+  ftpd_histogram_t timers[FTPD_TIMERS];
+  atomic_uint_least64_t replies[FTPD_STATS_CODES];
+} ftpd_slot_t;
+
+
+/**
+ * @brief Statistics of a server.
+ */
+struct ftpd_stats {
+  ftpd_slot_t *slots;           /**< FTPD_STATS_SLOTS blocks. */
+  atomic_int attached;          /**< Blocks given to threads. */
+  uint64_t started;             /**< When the server started, in us. */
+  pthread_mutex_t rate_lock;    /**< Guards the rest. */
+  uint64_t rate_stamp;          /**< Time of the previous JSON snapshot. */
+  uint64_t rate_bytes[2];       /**< Bytes in and out at that time. */
+  int listen_fd;                /**< Endpoint socket, or -1. */
+  int wake_fd;                  /**< eventfd that stops the thread. */
+  pthread_t thread;             /**< Thread serving the endpoint. */
+};
+
+
+/** Block of the calling thread, valid for local_owner only. */
+static _Thread_local ftpd_slot_t *local_slot;
+static _Thread_local struct ftpd_stats *local_owner;
+
+
+/**
+ * @brief Growable text buffer.
+ */
+typedef struct {
+  char *buf;
+  size_t len;
+  size_t cap;
+  bool failed;
+} ftpd_text_t;
+
+
+struct ftpd_stats *ftpd_stats_create(void) {
+  struct ftpd_stats *stats = calloc(1, sizeof(*stats));
+  if (!stats) {
+    return NULL;
+  }
+  stats->slots = aligned_alloc(alignof(ftpd_slot_t),
+                               FTPD_STATS_SLOTS * sizeof(ftpd_slot_t));
+  if (!stats->slots) {
+    free(stats);
+    return NULL;
+  }
+  memset(stats->slots, 0, FTPD_STATS_SLOTS * sizeof(ftpd_slot_t));
+  pthread_mutex_init(&stats->rate_lock, NULL);
+  stats->started = ftpd_stats_now();
+  stats->rate_stamp = stats->started;
+  stats->listen_fd = -1;
+  stats->wake_fd = -1;
+  return stats;
+}
+
+
+void ftpd_stats_destroy(struct ftpd_stats *stats) {
+  if (!stats) {
+    return;
+  }
+  pthread_mutex_destroy(&stats->rate_lock);
+  free(stats->slots);
+  free(stats);
+}
+
+
+void ftpd_stats_attach(struct ftpd_stats *stats) {
+  int slot = atomic_fetch_add(&stats->attached, 1) + 1;
+  if (slot < FTPD_STATS_SLOTS) {
+    local_slot = &stats->slots[slot];
+    local_owner = stats;
+  }
+}
+
+
+uint64_t ftpd_stats_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+
+/**
+ * @brief Block the calling thread records into.
+ *
+ * @param stats Statistics.
+ * @return Its own block if attached, else the shared one.
+ */
+static ftpd_slot_t *slot_of(struct ftpd_stats *stats) {
+  return local_owner == stats ? local_slot : &stats->slots[0];
+}
+
+
+/**
+ * @brief Add to a counter without ordering; it is only ever summed.
+ *
+ * @param counter Counter.
+ * @param n Amount.
+ */
+static void bump(atomic_uint_least64_t *counter, uint64_t n) {
+  atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+
+/**
+ * @brief Record a duration in a histogram.
+ *
+ * @param hist Histogram.
+ * @param us Duration in microseconds.
+ */
+static void observe(ftpd_histogram_t *hist, uint64_t us) {
+  int i = 0;
+  while (i < FTPD_STATS_BUCKETS - 1 && us > bucket_bounds[i]) {
+    i++;
+  }
+  bump(&hist->buckets[i], 1);
+  bump(&hist->sum_us, us);
+}
+
+
+void ftpd_stats_add(struct ftpd_stats *stats, ftpd_counter_t counter,
+                    uint64_t n) {
+  bump(&slot_of(stats)->counters[counter], n);
+}
+
+
+void ftpd_stats_time(struct ftpd_stats *stats, ftpd_timer_t timer,
+                     uint64_t us) {
+  observe(&slot_of(stats)->timers[timer], us);
+}
+
+
+void ftpd_stats_command(struct ftpd_stats *stats, int command, uint64_t us) {
+  if (command >= 0 && command < FTPD_STATS_COMMANDS) {
+    observe(&slot_of(stats)->commands[command], us);
+  }
+}
+
+
+void ftpd_stats_reply(struct ftpd_stats *stats, int code) {
+  if (code >= 400 && code < 400 + FTPD_STATS_CODES) {
+    bump(&slot_of(stats)->replies[code - 400], 1);
+  }
+}
+
+
+/**
+ * @brief Sum one counter over all blocks.
+ *
+ * @param stats Statistics.
+ * @param offset Offset of the counter in a block.
+ * @return Sum.
+ */
+static uint64_t sum_at(struct ftpd_stats *stats, size_t offset) {
+  uint64_t sum = 0;
+  for (int i = 0; i < FTPD_STATS_SLOTS; i++) {
+    atomic_uint_least64_t *counter =
+        (atomic_uint_least64_t *)((char *)&stats->slots[i] + offset);
+    sum += atomic_load_explicit(counter, memory_order_relaxed);
+  }
+  return sum;
+}
+
+
+/** Sum a field of ftpd_slot_t over all blocks. */
+#define SUM(stats, field) sum_at((stats), offsetof(ftpd_slot_t, field))
+
+
+/**
+ * @brief A histogram summed over all blocks, with cumulative buckets.
+ */
+typedef struct {
+  uint64_t buckets[FTPD_STATS_BUCKETS];
+  uint64_t sum_us;
+} ftpd_totals_t;
+
+
+/**
+ * @brief Sum a histogram over all blocks.
+ *
+ * @param stats Statistics.
+ * @param offset Offset of the histogram in a block.
+ * @param totals Set to the sums, buckets made cumulative.
+ * @return Number of durations recorded.
+ */
+static uint64_t sum_histogram(struct ftpd_stats *stats, size_t offset,
+                              ftpd_totals_t *totals) {
+  uint64_t count = 0;
+  for (int b = 0; b < FTPD_STATS_BUCKETS; b++) {
+    count += sum_at(stats, offset + offsetof(ftpd_histogram_t, buckets) +
+                    (size_t)b * sizeof(atomic_uint_least64_t));
+    totals->buckets[b] = count;
+  }
+  totals->sum_us = sum_at(stats, offset + offsetof(ftpd_histogram_t, sum_us));
+  return count;
+}
+
+
+/**
+ * @brief Append formatted text, growing the buffer as needed.
+ *
+ * @param text Buffer.
+ * @param fmt Printf-style format string.
+ * @param ... Format arguments.
+ */
+__attribute__((format(printf, 2, 3)))
+static void text_printf(ftpd_text_t *text, const char *fmt, ...) {
+  while (!text->failed) {
+    va_list args;
+    va_start(args, fmt);
+    size_t room = text->cap - text->len;
+    int len = vsnprintf(text->buf ? text->buf + text->len : NULL, room,
+                        fmt, args);
+    va_end(args);
+
+    if (len < 0) {
+      text->failed = true;
+    } else if ((size_t)len < room) {
+      text->len += (size_t)len;
+      return;
+    } else {
+      size_t cap = text->cap ? text->cap * 2 : 4096;
+      while (cap - text->len <= (size_t)len) {
+        cap *= 2;
+      }
+      char *grown = realloc(text->buf, cap);
+      if (!grown) {
+        text->failed = true;
+      } else {
+        text->buf = grown;
+        text->cap = cap;
+      }
+    }
+  }
+}
+
+
+/**
+ * @brief Append a histogram in the Prometheus format.
+ *
+ * @param text Buffer.
+ * @param name Metric name.
+ * @param label Label of the series, such as command="RETR", or "".
+ * @param totals Histogram.
+ * @param count Number of durations.
+ */
+static void prometheus_histogram(ftpd_text_t *text, const char *name,
+                                 const char *label,
+                                 const ftpd_totals_t *totals,
+                                 uint64_t count) {
+  const char *sep = label[0] ? "," : "";
+  for (int b = 0; b < FTPD_STATS_BUCKETS; b++) {
+    text_printf(text, "%s_bucket{%s%sle=\"%s\"} %llu\n", name, label, sep,
+                bucket_labels[b], (unsigned long long)totals->buckets[b]);
+  }
+  const char *open = label[0] ? "{" : "";
+  const char *close = label[0] ? "}" : "";
+  text_printf(text, "%s_sum%s%s%s %.6f\n", name, open, label, close,
+              (double)totals->sum_us / 1e6);
+  text_printf(text, "%s_count%s%s%s %llu\n", name, open, label, close,
+              (unsigned long long)count);
+}
+
+
+/**
+ * @brief Append a histogram as a JSON object.
+ *
+ * @param text Buffer.
+ * @param totals Histogram.
+ * @param count Number of durations.
+ */
+static void json_histogram(ftpd_text_t *text, const ftpd_totals_t *totals,
+                           uint64_t count) {
+  text_printf(text, "{\"count\":%llu,\"sum_seconds\":%.6f,\"buckets\":{",
+              (unsigned long long)count, (double)totals->sum_us / 1e6);
+  for (int b = 0; b < FTPD_STATS_BUCKETS; b++) {
+    text_printf(text, "%s\"%s\":%llu", b ? "," : "", bucket_labels[b],
+                (unsigned long long)totals->buckets[b]);
+  }
+  text_printf(text, "}}");
+}
+
+
+/**
+ * @brief Append a snapshot in the Prometheus text format.
+ *
+ * @param text Buffer.
+ * @param server Pointer to server structure.
+ * @param sessions Control connections open.
+ * @param transfers Transfers queued or running.
+ */
+static void format_prometheus(ftpd_text_t *text, ftpd_server_t *server,
+                              int sessions, int transfers) {
+  struct ftpd_stats *stats = server->stats;
+  double uptime = (double)(ftpd_stats_now() - stats->started) / 1e6;
+
+  text_printf(text,
+              "# HELP ftpd_uptime_seconds Time since the server started.\n"
+              "# TYPE ftpd_uptime_seconds gauge\n"
+              "ftpd_uptime_seconds %.3f\n"
+              "# HELP ftpd_sessions Control connections open.\n"
+              "# TYPE ftpd_sessions gauge\n"
+              "ftpd_sessions %d\n"
+              "# HELP ftpd_transfers Transfers queued or running.\n"
+              "# TYPE ftpd_transfers gauge\n"
+              "ftpd_transfers %d\n",
+              uptime, sessions, transfers);
+  text_printf(text,
+              "# HELP ftpd_connections_total Control connections "
+              "accepted.\n"
+              "# TYPE ftpd_connections_total counter\n"
+              "ftpd_connections_total %llu\n"
+              "# HELP ftpd_connections_refused_total Connections refused "
+              "for want of room.\n"
+              "# TYPE ftpd_connections_refused_total counter\n"
+              "ftpd_connections_refused_total %llu\n"
+              "# HELP ftpd_data_bytes_total Bytes moved over data "
+              "connections.\n"
+              "# TYPE ftpd_data_bytes_total counter\n"
+              "ftpd_data_bytes_total{direction=\"in\"} %llu\n"
+              "ftpd_data_bytes_total{direction=\"out\"} %llu\n"
+              "# HELP ftpd_cache_lookups_total Downloads of files small "
+              "enough to cache.\n"
+              "# TYPE ftpd_cache_lookups_total counter\n"
+              "ftpd_cache_lookups_total{result=\"hit\"} %llu\n"
+              "ftpd_cache_lookups_total{result=\"miss\"} %llu\n",
+              (unsigned long long)SUM(stats,
+                                      counters[FTPD_COUNT_CONNECTIONS]),
+              (unsigned long long)SUM(stats, counters[FTPD_COUNT_REFUSED]),
+              (unsigned long long)SUM(stats, counters[FTPD_COUNT_BYTES_IN]),
+              (unsigned long long)SUM(stats,
+                                      counters[FTPD_COUNT_BYTES_OUT]),
+              (unsigned long long)SUM(stats,
+                                      counters[FTPD_COUNT_CACHE_HITS]),
+              (unsigned long long)SUM(stats,
+                                      counters[FTPD_COUNT_CACHE_MISSES]));
+
+  text_printf(text,
+              "# HELP ftpd_command_duration_seconds Time to run a command, "
+              "transfer included.\n"
+              "# TYPE ftpd_command_duration_seconds histogram\n");
+  for (int i = 0; i < FTPD_STATS_COMMANDS && ftpd_command_name(i); i++) {
+    ftpd_totals_t totals;
+    uint64_t count = sum_histogram(stats, offsetof(ftpd_slot_t, commands) +
+                                   (size_t)i * sizeof(ftpd_histogram_t),
+                                   &totals);
+    if (count > 0) {
+      char label[32];
+      snprintf(label, sizeof(label), "command=\"%s\"", ftpd_command_name(i));
+      prometheus_histogram(text, "ftpd_command_duration_seconds", label,
+                           &totals, count);
+    }
+  }
+
+  static const char *const help[FTPD_TIMERS] = {
+    "Time of completed uploads.",
+    "Time of completed downloads.",
+    "Time transfers waited for a worker."
+  };
+  for (int t = 0; t < FTPD_TIMERS; t++) {
+    char name[64];
+    snprintf(name, sizeof(name), "ftpd_%s_duration_seconds", timer_names[t]);
+    text_printf(text, "# HELP %s %s\n# TYPE %s histogram\n",
+                name, help[t], name);
+    ftpd_totals_t totals;
+    uint64_t count = sum_histogram(stats, offsetof(ftpd_slot_t, timers) +
+                                   (size_t)t * sizeof(ftpd_histogram_t),
+                                   &totals);
+    prometheus_histogram(text, name, "", &totals, count);
+  }
+
+  text_printf(text,
+              "# HELP ftpd_error_replies_total Error replies sent, by "
+              "code.\n"
+              "# TYPE ftpd_error_replies_total counter\n");
+  for (int c = 0; c < FTPD_STATS_CODES; c++) {
+    uint64_t n = SUM(stats, replies[c]);
+    if (n > 0) {
+      text_printf(text, "ftpd_error_replies_total{code=\"%d\"} %llu\n",
+                  400 + c, (unsigned long long)n);
+    }
+  }
+}
+
+
+/**
+ * @brief Append a snapshot as one JSON object.
+ *
+ * @param text Buffer.
+ * @param server Pointer to server structure.
+ * @param sessions Control connections open.
+ * @param transfers Transfers queued or running.
+ */
+static void format_json(ftpd_text_t *text, ftpd_server_t *server,
+                        int sessions, int transfers) {
+  struct ftpd_stats *stats = server->stats;
+  uint64_t now = ftpd_stats_now();
+  uint64_t bytes[2] = {
+    SUM(stats, counters[FTPD_COUNT_BYTES_IN]),
+    SUM(stats, counters[FTPD_COUNT_BYTES_OUT])
+  };
+
+  /* Rates over the time since the previous snapshot */
+  double rates[2] = {0, 0};
+  pthread_mutex_lock(&stats->rate_lock);
+  double span = (double)(now - stats->rate_stamp) / 1e6;
+  for (int i = 0; i < 2; i++) {
+    if (span > 0) {
+      rates[i] = (double)(bytes[i] - stats->rate_bytes[i]) / span;
+    }
+    stats->rate_bytes[i] = bytes[i];
+  }
+  stats->rate_stamp = now;
+  pthread_mutex_unlock(&stats->rate_lock);
+
+  text_printf(text,
+              "{\"uptime_seconds\":%.3f,\"sessions\":%d,\"transfers\":%d,"
+              "\"connections\":%llu,\"connections_refused\":%llu,"
+              "\"bytes_in\":%llu,\"bytes_out\":%llu,"
+              "\"bytes_in_per_second\":%.1f,\"bytes_out_per_second\":%.1f,"
+              "\"cache_hits\":%llu,\"cache_misses\":%llu,"
+              "\"commands\":{",
+              (double)(now - stats->started) / 1e6, sessions, transfers,
+              (unsigned long long)SUM(stats,
+                                      counters[FTPD_COUNT_CONNECTIONS]),
+              (unsigned long long)SUM(stats, counters[FTPD_COUNT_REFUSED]),
+              (unsigned long long)bytes[0], (unsigned long long)bytes[1],
+              rates[0], rates[1],
+              (unsigned long long)SUM(stats,
+                                      counters[FTPD_COUNT_CACHE_HITS]),
+              (unsigned long long)SUM(stats,
+                                      counters[FTPD_COUNT_CACHE_MISSES]));
+
+  bool first = true;
+  for (int i = 0; i < FTPD_STATS_COMMANDS && ftpd_command_name(i); i++) {
+    ftpd_totals_t totals;
+    uint64_t count = sum_histogram(stats, offsetof(ftpd_slot_t, commands) +
+                                   (size_t)i * sizeof(ftpd_histogram_t),
+                                   &totals);
+    if (count > 0) {
+      text_printf(text, "%s\"%s\":", first ? "" : ",", ftpd_command_name(i));
+      json_histogram(text, &totals, count);
+      first = false;
+    }
+  }
+  text_printf(text, "}");
+
+  for (int t = 0; t < FTPD_TIMERS; t++) {
+    ftpd_totals_t totals;
+    uint64_t count = sum_histogram(stats, offsetof(ftpd_slot_t, timers) +
+                                   (size_t)t * sizeof(ftpd_histogram_t),
+                                   &totals);
+    text_printf(text, ",\"%s\":", timer_names[t]);
+    json_histogram(text, &totals, count);
+  }
+
+  text_printf(text, ",\"errors\":{");
+  first = true;
+  for (int c = 0; c < FTPD_STATS_CODES; c++) {
+    uint64_t n = SUM(stats, replies[c]);
+    if (n > 0) {
+      text_printf(text, "%s\"%d\":%llu", first ? "" : ",", 400 + c,
+                  (unsigned long long)n);
+      first = false;
+    }
+  }
+  text_printf(text, "}}\n");
+}
+
+
+char *ftpd_stats_format(ftpd_server_t *server, ftpd_stats_format_t format,
+                        size_t *len) {
+  int sessions = 0;
+  for (int i = 0; i < server->loop_count; i++) {
+    sessions += atomic_load_explicit(&server->loops[i].client_count,
+                                     memory_order_relaxed);
+  }
+  pthread_mutex_lock(&server->jobs_lock);
+  int transfers = server->active_jobs;
+  pthread_mutex_unlock(&server->jobs_lock);
+
+  ftpd_text_t text = {0};
+  if (format == FTPD_STATS_JSON) {
+    format_json(&text, server, sessions, transfers);
+  } else {
+    format_prometheus(&text, server, sessions, transfers);
+  }
+
+  if (text.failed) {
+    free(text.buf);
+    return NULL;
+  }
+  *len = text.len;
+  return text.buf;
+}
+
+
+/**
+ * @brief Send all of a buffer on a stats connection.
+ *
+ * @param fd Socket.
+ * @param data Data.
+ * @param len Length of data.
+ * @return 0 on success, -1 on error.
+ */
+static int send_all(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    data += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+
+/**
+ * @brief Answer one HTTP request for a snapshot.
+ *
+ * @param server Pointer to server structure.
+ * @param fd Connected socket.
+ */
+static void serve_request(ftpd_server_t *server, int fd) {
+  struct timeval tv = {
+    .tv_sec = FTPD_STATS_TIMEOUT_MS / 1000,
+    .tv_usec = (FTPD_STATS_TIMEOUT_MS % 1000) * 1000
+  };
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+  /* Only the request line matters; headers are read and ignored */
+  char request[FTPD_STATS_REQUEST];
+  size_t len = 0;
+  while (len < sizeof(request) - 1) {
+    ssize_t n = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    len += (size_t)n;
+    request[len] = '\0';
+    if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) {
+      break;
+    }
+  }
+  request[len] = '\0';
+
+  char method[8], path[256];
+  const char *status = "200 OK";
+  const char *type = "text/plain; version=0.0.4";
+  char *body = NULL;
+  size_t body_len = 0;
+  if (sscanf(request, "%7s %255s", method, path) != 2 ||
+      strcmp(method, "GET") != 0) {
+    status = "405 Method Not Allowed";
+  } else if (strcmp(path, "/metrics") == 0) {
+    body = ftpd_stats_format(server, FTPD_STATS_PROMETHEUS, &body_len);
+  } else if (strcmp(path, "/stats") == 0) {
+    type = "application/json";
+    body = ftpd_stats_format(server, FTPD_STATS_JSON, &body_len);
+  } else {
+    status = "404 Not Found";
+  }
+  if (strcmp(status, "200 OK") == 0 && !body) {
+    status = "500 Internal Server Error";
+  }
+
+  char header[256];
+  int header_len = snprintf(header, sizeof(header),
+                            "HTTP/1.0 %s\r\n"
+                            "Content-Type: %s\r\n"
+                            "Content-Length: %zu\r\n"
+                            "Connection: close\r\n\r\n",
+                            status, body ? type : "text/plain", body_len);
+  if (send_all(fd, header, (size_t)header_len) == 0 && body) {
+    send_all(fd, body, body_len);
+  }
+  free(body);
+}
+
+
+/**
+ * @brief Thread serving the stats endpoint until woken to stop.
+ *
+ * @param arg Pointer to ftpd_server_t structure.
+ * @return NULL always.
+ */
+static void *stats_main(void *arg) {
+  ftpd_server_t *server = (ftpd_server_t *)arg;
+  struct pollfd fds[2] = {
+    { .fd = server->stats->listen_fd, .events = POLLIN },
+    { .fd = server->stats->wake_fd, .events = POLLIN }
+  };
+
+  for (;;) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (fds[1].revents) {
+      break;
+    }
+    int fd = accept4(fds[0].fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN) {
+        continue;
+      }
+      break;
+    }
+    serve_request(server, fd);
+    close(fd);
+  }
+  return NULL;
+}
+
+
+int ftpd_stats_start(ftpd_server_t *server, int fd) {
+  struct ftpd_stats *stats = server->stats;
+  if (fd < 0) {
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      perror("ftpd: stats socket");
+      return -1;
+    }
+
+    int optval = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+
+    /* Loopback only: the numbers are for the host's own monitoring */
+    struct sockaddr_in addr = {
+      .sin_family = AF_INET,
+      .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+      .sin_port = htons(server->config.stats_port)
+    };
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd, 16) < 0) {
+      perror("ftpd: stats bind");
+      close(fd);
+      return -1;
+    }
+  }
+
+  stats->wake_fd = eventfd(0, EFD_CLOEXEC);
+  if (stats->wake_fd < 0) {
+    perror("ftpd: eventfd");
+    close(fd);
+    return -1;
+  }
+
+  sigset_t block, old;
+  sigemptyset(&block);
+  sigaddset(&block, SIGINT);
+  sigaddset(&block, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &block, &old);
+
+  stats->listen_fd = fd;
+  int err = pthread_create(&stats->thread, NULL, stats_main, server);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (err != 0) {
+    fprintf(stderr, "ftpd: pthread_create: %s\n", strerror(err));
+    close(fd);
+    close(stats->wake_fd);
+    stats->listen_fd = -1;
+    stats->wake_fd = -1;
+    return -1;
+  }
+
+  printf("ftpd: stats on 127.0.0.1:%d\n", server->config.stats_port);
+  return 0;
+}
+
+
+int ftpd_stats_socket(const ftpd_server_t *server) {
+  return server->stats ? server->stats->listen_fd : -1;
+}
+
+
+void ftpd_stats_stop(ftpd_server_t *server) {
+  struct ftpd_stats *stats = server->stats;
+  if (!stats || stats->listen_fd < 0) {
+    return;
+  }
+
+  /* The socket is not shut down: a new server may have taken it over */
+  eventfd_write(stats->wake_fd, 1);
+  pthread_join(stats->thread, NULL);
+  close(stats->listen_fd);
+  close(stats->wake_fd);
+  stats->listen_fd = -1;
+  stats->wake_fd = -1;
+}
@@ -0,0 +1,181 @@
+/**
+ * @file ftpd_stats.h
+ * @brief Server counters and histograms, and the stats endpoint.
+ *
+ * Each thread that records gets a block of counters of its own, so
+ * recording is a relaxed atomic add to memory no other thread writes;
+ * a snapshot sums the blocks. Threads beyond the number of blocks share
+ * the first one, which the atomics keep correct.
+ *
+ * Snapshots are served on a port of the loopback address over HTTP:
+ * /metrics in the Prometheus text format and /stats as JSON. SITE STATS
+ * sends the JSON on the control connection.
+ */
+
+#ifndef FTPD_STATS_H
+#define FTPD_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ftpd.h"
+
+
+/** Histograms for commands, by their index in the command table. */
+#define FTPD_STATS_COMMANDS 48
+
+
+/**
+ * @brief Counters.
+ */
+typedef enum {
+  FTPD_COUNT_CONNECTIONS,   /**< Control connections accepted. */
+  FTPD_COUNT_REFUSED,       /**< Connections refused at max_clients. */
+  FTPD_COUNT_BYTES_IN,      /**< Data bytes received. */
+  FTPD_COUNT_BYTES_OUT,     /**< Data bytes sent, listings included. */
+  FTPD_COUNT_CACHE_HITS,    /**< Downloads sent from the file cache. */
+  FTPD_COUNT_CACHE_MISSES,  /**< Files read into the file cache. */
+  FTPD_COUNTERS
+} ftpd_counter_t;
+
+
+/**
+ * @brief Timings kept as histograms, besides those of commands.
+ */
+typedef enum {
+  FTPD_TIME_UPLOAD,         /**< Completed STOR and APPE transfers. */
+  FTPD_TIME_DOWNLOAD,       /**< Completed RETR transfers. */
+  FTPD_TIME_QUEUE,          /**< Waits of transfers for a worker. */
+  FTPD_TIMERS
+} ftpd_timer_t;
+
+
+/**
+ * @brief Snapshot formats.
+ */
+typedef enum {
+  FTPD_STATS_PROMETHEUS,    /**< Prometheus text exposition format. */
+  FTPD_STATS_JSON           /**< One JSON object on one line. */
+} ftpd_stats_format_t;
+
+
+/**
+ * @brief Allocate zeroed statistics.
+ *
+ * @return Statistics, or NULL if out of memory.
+ */
+struct ftpd_stats *ftpd_stats_create(void);
+
+
+/**
+ * @brief Free statistics; the endpoint must be stopped.
+ *
+ * @param stats Statistics, or NULL.
+ */
+void ftpd_stats_destroy(struct ftpd_stats *stats);
+
+
+/**
+ * @brief Give the calling thread a block of counters of its own.
+ *
+ * @param stats Statistics.
+ */
+void ftpd_stats_attach(struct ftpd_stats *stats);
+
+
+/**
+ * @brief Current time for timings, in microseconds.
+ *
+ * @return Microseconds of the monotonic clock.
+ */
+uint64_t ftpd_stats_now(void);
+
+
+/**
+ * @brief Add to a counter.
+ *
+ * @param stats Statistics.
+ * @param counter Counter.
+ * @param n Amount.
+ */
+void ftpd_stats_add(struct ftpd_stats *stats, ftpd_counter_t counter,
+                    uint64_t n);
+
+
+/**
+ * @brief Record a timing.
+ *
+ * @param stats Statistics.
+ * @param timer Histogram.
+ * @param us Duration in microseconds.
+ */
+void ftpd_stats_time(struct ftpd_stats *stats, ftpd_timer_t timer,
+                     uint64_t us);
+
+
+/**
+ * @brief Record how long a command took, transfer included.
+ *
+ * @param stats Statistics.
+ * @param command Index of the command in the command table.
+ * @param us Duration in microseconds.
+ */
+void ftpd_stats_command(struct ftpd_stats *stats, int command, uint64_t us);
+
+
+/**
+ * @brief Count a reply; only error replies, 400 to 599, are kept.
+ *
+ * @param stats Statistics.
+ * @param code Reply code.
+ */
+void ftpd_stats_reply(struct ftpd_stats *stats, int code);
+
+
+/**
+ * @brief Format a snapshot of a server's statistics.
+ *
+ * The JSON includes the data rates since the previous JSON snapshot,
+ * or since the server started.
+ *
+ * @param server Pointer to server structure.
+ * @param format Format.
+ * @param len Set to the length of the text.
+ * @return Allocated text, or NULL if out of memory. Caller must free.
+ */
+char *ftpd_stats_format(ftpd_server_t *server, ftpd_stats_format_t format,
+                        size_t *len);
+
+
+/**
+ * @brief Serve snapshots on config.stats_port of the loopback address.
+ *
+ * Requests are answered one at a time by a thread of their own, which
+ * blocks SIGINT and SIGTERM like the workers.
+ *
+ * @param server Pointer to server structure.
+ * @param fd Non-blocking listening socket taken over from the server
+ *        being replaced, or -1 to bind one.
+ * @return 0 on success, -1 on error.
+ */
+int ftpd_stats_start(ftpd_server_t *server, int fd);
+
+
+/**
+ * @brief Socket of the stats endpoint, to hand over to a new server.
+ *
+ * @param server Pointer to server structure.
+ * @return The listening socket, or -1 if not serving.
+ */
+int ftpd_stats_socket(const ftpd_server_t *server);
+
+
+/**
+ * @brief Stop serving snapshots, if started.
+ *
+ * @param server Pointer to server structure.
+ */
+void ftpd_stats_stop(ftpd_server_t *server);
+
+
+#endif /* FTPD_STATS_H */
@@ -0,0 +1,220 @@
+/**
+ * @file ftpd_tls.c
+ * @brief TLS on the control and data connections implementation.
+ *
+ * The control socket is non-blocking and served by the event loop, so
+ * reads and writes report OpenSSL's "want read" and "want write" as
+ * EAGAIN, like recv() and send() would. Handshakes, which take several
+ * round trips, run on a worker and poll until done or timed out.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include "ftpd.h"
+#include "ftpd_tls.h"
+
+
+/** Session ID context; sessions resume on any connection to ftpd. */
+static const unsigned char session_context[] = "jbox-ftpd";
+
+
+int ftpd_tls_init(ftpd_server_t *server) {
+  const char *cert = server->config.tls_cert;
+  if (!cert) {
+    return 0;
+  }
+  const char *key = server->config.tls_key ? server->config.tls_key : cert;
+
+  SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+  if (!ctx) {
+    fprintf(stderr, "ftpd: cannot create TLS context\n");
+    return -1;
+  }
+
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+  SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION |
+                           SSL_OP_IGNORE_UNEXPECTED_EOF);
+  /* An idle control connection keeps no record buffers */
+  SSL_CTX_set_mode(ctx, SSL_MODE_RELEASE_BUFFERS);
+  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+  SSL_CTX_set_session_id_context(ctx, session_context,
+                                 sizeof(session_context) - 1);
+
+  if (SSL_CTX_use_certificate_chain_file(ctx, cert) != 1 ||
+      SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) != 1 ||
+      SSL_CTX_check_private_key(ctx) != 1) {
+    fprintf(stderr, "ftpd: cannot load TLS certificate %s and key %s\n",
+            cert, key);
+    ERR_print_errors_fp(stderr);
+    SSL_CTX_free(ctx);
+    return -1;
+  }
+
+  server->tls_ctx = ctx;
+  return 0;
+}
+
+
+void ftpd_tls_free(ftpd_server_t *server) {
+  SSL_CTX_free(server->tls_ctx);
+  server->tls_ctx = NULL;
+}
+
+
+/**
+ * @brief Milliseconds of the monotonic clock.
+ *
+ * @return Current time in ms.
+ */
+static long now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+struct ssl_st *ftpd_tls_accept(ftpd_server_t *server, int fd) {
+  /* OpenSSL reads the thread's error queue to explain a failure */
+  ERR_clear_error();
+  SSL *ssl = SSL_new(server->tls_ctx);
+  if (!ssl || SSL_set_fd(ssl, fd) != 1) {
+    SSL_free(ssl);
+    return NULL;
+  }
+
+  /* Poll rather than block, so that a silent client times out */
+  int flags = fcntl(fd, F_GETFL);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+    SSL_free(ssl);
+    return NULL;
+  }
+
+  long deadline = now_ms() + FTPD_DATA_TIMEOUT_MS;
+  int rc;
+  while ((rc = SSL_accept(ssl)) != 1) {
+    int err = SSL_get_error(ssl, rc);
+    short events = err == SSL_ERROR_WANT_READ ? POLLIN :
+                   err == SSL_ERROR_WANT_WRITE ? POLLOUT : 0;
+    long left = deadline - now_ms();
+    if (!events || left <= 0) {
+      break;
+    }
+    struct pollfd pfd = { .fd = fd, .events = events };
+    if (poll(&pfd, 1, (int)left) < 0 && errno != EINTR) {
+      break;
+    }
+  }
+  fcntl(fd, F_SETFL, flags);
+
+  if (rc != 1) {
+    SSL_set_quiet_shutdown(ssl, 1);
+    SSL_free(ssl);
+    ERR_clear_error();
+    return NULL;
+  }
+  return ssl;
+}
+
+
+/**
+ * @brief Turn a failed TLS read or write into errno.
+ *
+ * @param ssl Connection.
+ * @param rc What the call returned.
+ * @return 0 for the peer's close_notify, -1 otherwise.
+ */
+static ssize_t tls_error(SSL *ssl, int rc) {
+  int err = SSL_get_error(ssl, rc);
+  switch (err) {
+    case SSL_ERROR_ZERO_RETURN:
+      return 0;
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+      /* A blocking socket only wants more after a signal */
+      if (errno != EINTR) {
+        errno = EAGAIN;
+      }
+      return -1;
+    case SSL_ERROR_SYSCALL:
+      if (errno == 0) {
+        errno = EIO;
+      }
+      break;
+    default:
+      errno = EIO;
+      break;
+  }
+
+  /* After a fatal error no close_notify may be sent */
+  SSL_set_quiet_shutdown(ssl, 1);
+  ERR_clear_error();
+  return -1;
+}
+
+
+ssize_t ftpd_tls_read(struct ssl_st *ssl, void *buf, size_t len) {
+  ERR_clear_error();
+  errno = 0;
+  size_t n;
+  int rc = SSL_read_ex(ssl, buf, len, &n);
+  return rc == 1 ? (ssize_t)n : tls_error(ssl, rc);
+}
+
+
+ssize_t ftpd_tls_write(struct ssl_st *ssl, const void *buf, size_t len) {
+  ERR_clear_error();
+  errno = 0;
+  size_t n;
+  int rc = SSL_write_ex(ssl, buf, len, &n);
+  return rc == 1 ? (ssize_t)n : tls_error(ssl, rc);
+}
+
+
+ssize_t ftpd_tls_sendfile(struct ssl_st *ssl, int fd, off_t offset,
+                          size_t len) {
+  if (!BIO_get_ktls_send(SSL_get_wbio(ssl))) {
+    errno = EOPNOTSUPP;
+    return -1;
+  }
+
+  ERR_clear_error();
+  ossl_ssize_t n = SSL_sendfile(ssl, fd, offset, len, 0);
+  if (n < 0) {
+    int err = errno;
+    SSL_set_quiet_shutdown(ssl, 1);
+    ERR_clear_error();
+    errno = err;
+    return -1;
+  }
+  return (ssize_t)n;
+}
+
+
+bool ftpd_tls_pending(struct ssl_st *ssl) {
+  return ssl && SSL_pending(ssl) > 0;
+}
+
+
+void ftpd_tls_close(struct ssl_st *ssl, int wait_ms) {
+  if (!ssl) {
+    return;
+  }
+
+  ERR_clear_error();
+  if (SSL_shutdown(ssl) == 0 && wait_ms > 0) {
+    struct pollfd pfd = { .fd = SSL_get_fd(ssl), .events = POLLIN };
+    if (poll(&pfd, 1, wait_ms) > 0) {
+      SSL_shutdown(ssl);
+    }
+  }
+  SSL_free(ssl);
+  ERR_clear_error();
+}
@@ -0,0 +1,119 @@
+/**
+ * @file ftpd_tls.h
+ * @brief TLS on the control and data connections (FTPS, RFC 4217).
+ *
+ * AUTH TLS makes the control connection a TLS one, and PROT P the data
+ * connections after it. The server caches sessions and issues tickets,
+ * so a data connection, or a client coming back, resumes a session
+ * rather than doing a full handshake.
+ *
+ * The context asks OpenSSL for kernel TLS. Where the kernel and OpenSSL
+ * have it, the kernel encrypts what is written to the socket once the
+ * handshake is done, and files still go out with sendfile(); elsewhere
+ * OpenSSL encrypts them from a buffer.
+ */
+
+#ifndef FTPD_TLS_H
+#define FTPD_TLS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "ftpd.h"
+
+
+/**
+ * @brief Set up the server's TLS context from config.tls_cert and
+ *        config.tls_key; without a certificate TLS stays off.
+ *
+ * @param server Pointer to server structure.
+ * @return 0 on success, -1 on error.
+ */
+int ftpd_tls_init(ftpd_server_t *server);
+
+
+/**
+ * @brief Free the server's TLS context, if any.
+ *
+ * @param server Pointer to server structure.
+ */
+void ftpd_tls_free(ftpd_server_t *server);
+
+
+/**
+ * @brief Do the server side of a handshake on a connection.
+ *
+ * Blocks for up to FTPD_DATA_TIMEOUT_MS, whether or not the socket is
+ * non-blocking, and leaves its flags as they were.
+ *
+ * @param server Pointer to server structure with TLS set up.
+ * @param fd Connected socket; stays open and the caller's.
+ * @return Connection, or NULL if the handshake failed.
+ */
+struct ssl_st *ftpd_tls_accept(ftpd_server_t *server, int fd);
+
+
+/**
+ * @brief Read from a TLS connection.
+ *
+ * @param ssl Connection.
+ * @param buf Buffer for the data.
+ * @param len Size of buf.
+ * @return Bytes read, 0 once the peer has closed, or -1 with errno set
+ *         (EAGAIN if a non-blocking socket has nothing yet).
+ */
+ssize_t ftpd_tls_read(struct ssl_st *ssl, void *buf, size_t len);
+
+
+/**
+ * @brief Write to a TLS connection.
+ *
+ * On EAGAIN the write must be repeated with the same arguments.
+ *
+ * @param ssl Connection.
+ * @param buf Data to write.
+ * @param len Length of data.
+ * @return len, or -1 with errno set (EAGAIN if a non-blocking socket
+ *         is full).
+ */
+ssize_t ftpd_tls_write(struct ssl_st *ssl, const void *buf, size_t len);
+
+
+/**
+ * @brief Send part of a file with sendfile() if the kernel encrypts
+ *        for the connection.
+ *
+ * @param ssl Connection.
+ * @param fd File to send.
+ * @param offset Byte of the file to start at.
+ * @param len Most bytes to send.
+ * @return Bytes sent, 0 at the end of the file, or -1 with errno set
+ *         (EOPNOTSUPP without kernel TLS, before anything is sent).
+ */
+ssize_t ftpd_tls_sendfile(struct ssl_st *ssl, int fd, off_t offset,
+                          size_t len);
+
+
+/**
+ * @brief Whether data already read from the socket waits to be read.
+ *
+ * The socket is not readable for it, so epoll does not report it.
+ *
+ * @param ssl Connection, or NULL.
+ * @return true if ftpd_tls_read() would return data.
+ */
+bool ftpd_tls_pending(struct ssl_st *ssl);
+
+
+/**
+ * @brief Close a TLS connection, sending close_notify, and free it.
+ *
+ * @param ssl Connection, or NULL; the socket is left open.
+ * @param wait_ms How long to wait for the peer's close_notify, which
+ *        a client ending a download with its own waits for; 0 for none.
+ */
+void ftpd_tls_close(struct ssl_st *ssl, int wait_ms);
+
+
+#endif /* FTPD_TLS_H */
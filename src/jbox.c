@@ -3,8 +3,9 @@
  * @brief Main entry point for the jbox shell application.
  *
  * This file provides the main() function that dispatches to the jshell
- * implementation. It handles command name resolution (jbox vs jshell)
- * and provides a welcome message when appropriate.
+ * implementation. It handles command name resolution (jbox vs jshell, or
+ * one of the apps linked into jbox, reached through a symlink named after
+ * it) and provides a welcome message when appropriate.
  */
 
 #include <stdlib.h>
@@ -13,6 +14,7 @@
 #include <sys/mman.h>
 
 #include "jshell/jshell.h"
+#include "jshell/jshell_register_externals.h"
 #include "utils/jbox_utils.h"
 
 
@@ -21,7 +23,8 @@
  *
  * Determines which mode to run in based on the command name (argv[0]).
  * Supports both "jbox" and "jshell" invocations with appropriate handling
- * of flags and welcome messages.
+ * of flags and welcome messages. Any other name, or "jbox <app>", runs
+ * the linked app of that name.
  *
  * @param argc Argument count.
  * @param argv Argument vector.
@@ -40,11 +43,21 @@ int main(int argc, char *argv[]) {
     return jshell_main(argc, argv);
   }
 
+  const jshell_cmd_spec_t *app = jshell_find_linked_command(cmd);
+  if (app != NULL) {
+    return app->run(argc, argv);
+  }
+
   if (strcmp(cmd, "jbox") == 0) {
     if (argc > 1 && strcmp(argv[1], "jshell") == 0) {
       return jshell_main(argc - 1, argv + 1);
     }
 
+    app = (argc > 1) ? jshell_find_linked_command(argv[1]) : NULL;
+    if (app != NULL) {
+      return app->run(argc - 1, argv + 1);
+    }
+
     int has_c_flag = 0;
     for (int i = 1; i < argc; i++) {
       if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "-h") == 0
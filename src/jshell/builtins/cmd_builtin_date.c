@@ -0,0 +1,187 @@
+/**
+ * @file cmd_builtin_date.c
+ * @brief Implementation of the date builtin, reading the clock in-process
+ *
+ * The shell's own `date`, registered ahead of the date app linked into
+ * jbox, which runs as a child process whenever its output is a terminal.
+ * The time comes from clock_gettime(CLOCK_REALTIME), which the vDSO
+ * answers without a system call, and the time zone is loaded once and
+ * again only when TZ changes, where the app calls tzset() every time.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "argtable3.h"
+#include "jshell/jshell_cmd_registry.h"
+#include "jshell/jshell_io.h"
+
+
+/** TZ when the time zone was last loaded; pipeline stages may race */
+static pthread_mutex_t g_tz_lock = PTHREAD_MUTEX_INITIALIZER;
+static char g_loaded_tz[256];
+static bool g_tz_loaded = false;
+
+
+/**
+ * Arguments structure for the date builtin.
+ */
+typedef struct {
+  struct arg_lit *help;
+  struct arg_end *end;
+  void *argtable[2];
+} date_args_t;
+
+
+/**
+ * Builds the argtable3 structure for the date builtin.
+ *
+ * @param args Pointer to date_args_t structure to populate
+ */
+static void build_date_argtable(date_args_t *args) {
+  args->help = arg_lit0("h", "help", "display this help and exit");
+  args->end  = arg_end(20);
+
+  args->argtable[0] = args->help;
+  args->argtable[1] = args->end;
+}
+
+
+/**
+ * Frees memory allocated for the date argtable.
+ *
+ * @param args Pointer to date_args_t structure to cleanup
+ */
+static void cleanup_date_argtable(date_args_t *args) {
+  arg_freetable(args->argtable,
+                sizeof(args->argtable) / sizeof(args->argtable[0]));
+}
+
+
+/**
+ * Prints usage information for the date builtin.
+ *
+ * @param out Output stream to write usage information to
+ */
+static void date_print_usage(FILE *out) {
+  date_args_t args;
+  build_date_argtable(&args);
+  fprintf(out, "Usage: date");
+  arg_print_syntax(out, args.argtable, "\n");
+  fprintf(out, "Display the current date and time.\n\n");
+  fprintf(out, "Options:\n");
+  arg_print_glossary(out, args.argtable, "  %-20s %s\n");
+  cleanup_date_argtable(&args);
+}
+
+
+/**
+ * Passes the date argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void date_describe_args(jshell_argtable_visit_fn visit,
+                               void *userdata) {
+  date_args_t args;
+  build_date_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_date_argtable(&args);
+}
+
+
+/**
+ * Loads the time zone unless TZ is what it was at the last load.
+ * localtime_r() only loads it on first use, so it would miss a TZ
+ * exported later.
+ */
+static void refresh_time_zone(void) {
+  const char *tz = getenv("TZ");
+  const char *value = tz != NULL ? tz : "";
+  pthread_mutex_lock(&g_tz_lock);
+  if (!g_tz_loaded || strcmp(value, g_loaded_tz) != 0) {
+    tzset();
+    snprintf(g_loaded_tz, sizeof(g_loaded_tz), "%s", value);
+    g_tz_loaded = true;
+  }
+  pthread_mutex_unlock(&g_tz_lock);
+}
+
+
+/**
+ * Executes the date builtin.
+ *
+ * @param argc Number of arguments
+ * @param argv Array of argument strings
+ * @return 0 on success, 1 on failure
+ */
+static int date_run(int argc, char **argv) {
+  date_args_t args;
+  build_date_argtable(&args);
+
+  int nerrors = arg_parse(argc, argv, args.argtable);
+
+  if (args.help->count > 0) {
+    date_print_usage(jshell_io_stdout());
+    cleanup_date_argtable(&args);
+    return 0;
+  }
+
+  if (nerrors > 0) {
+    arg_print_errors(stderr, args.end, "date");
+    fprintf(stderr, "Try 'date --help' for more information.\n");
+    cleanup_date_argtable(&args);
+    return 1;
+  }
+
+  cleanup_date_argtable(&args);
+
+  struct timespec now;
+  if (clock_gettime(CLOCK_REALTIME, &now) == -1) {
+    perror("date: cannot get current time");
+    return 1;
+  }
+
+  struct tm tm_info;
+  refresh_time_zone();
+  if (localtime_r(&now.tv_sec, &tm_info) == NULL) {
+    perror("date: cannot convert time");
+    return 1;
+  }
+
+  char buffer[128];
+  if (strftime(buffer, sizeof(buffer), "%a %b %e %H:%M:%S %Z %Y", &tm_info)
+      == 0) {
+    fprintf(stderr, "date: cannot format time\n");
+    return 1;
+  }
+
+  jshell_printf("%s\n", buffer);
+  return 0;
+}
+
+
+/**
+ * Command specification for the date builtin.
+ */
+const jshell_cmd_spec_t cmd_builtin_date_spec = {
+  .name = "date",
+  .summary = "display the current date and time",
+  .long_help = "Display the current date and time in the default format.",
+  .type = CMD_BUILTIN,
+  .run = date_run,
+  .print_usage = date_print_usage,
+  .describe_args = date_describe_args
+};
+
+
+/**
+ * Registers the date builtin with the shell command registry.
+ */
+void jshell_register_builtin_date_command(void) {
+  jshell_register_command(&cmd_builtin_date_spec);
+}
@@ -0,0 +1,168 @@
+/**
+ * @file cmd_builtin_sleep.c
+ * @brief Implementation of the sleep builtin, waiting in the shell process
+ *
+ * The shell's own `sleep`, registered ahead of the sleep app linked into
+ * jbox: that app runs as a child process whenever its output is a
+ * terminal, so a polling loop paid a fork and exec per iteration. This
+ * one waits on a timerfd through jshell_event_sleep(), so SIGINT, `kill`
+ * of its job and a cancelled pipeline stop it without another thread.
+ * The standalone app is unchanged and still serves the jbox symlink.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "argtable3.h"
+#include "jshell/jshell_cmd_registry.h"
+#include "jshell/jshell_event_loop.h"
+#include "jshell/jshell_io.h"
+
+
+/** Longest sleep accepted, so the nanosecond count cannot overflow */
+#define SLEEP_MAX_SECONDS (100.0 * 365 * 24 * 3600)
+
+
+/**
+ * Arguments structure for the sleep builtin.
+ */
+typedef struct {
+  struct arg_lit *help;
+  struct arg_dbl *seconds;
+  struct arg_end *end;
+  void *argtable[3];
+} sleep_args_t;
+
+
+/**
+ * Builds the argtable3 structure for the sleep builtin.
+ *
+ * @param args Pointer to sleep_args_t structure to populate
+ */
+static void build_sleep_argtable(sleep_args_t *args) {
+  args->help    = arg_lit0("h", "help", "display this help and exit");
+  args->seconds = arg_dbl1(NULL, NULL, "SECONDS",
+                           "pause for SECONDS (can be fractional)");
+  args->end     = arg_end(20);
+
+  args->argtable[0] = args->help;
+  args->argtable[1] = args->seconds;
+  args->argtable[2] = args->end;
+}
+
+
+/**
+ * Frees memory allocated for the sleep argtable.
+ *
+ * @param args Pointer to sleep_args_t structure to cleanup
+ */
+static void cleanup_sleep_argtable(sleep_args_t *args) {
+  arg_freetable(args->argtable,
+                sizeof(args->argtable) / sizeof(args->argtable[0]));
+}
+
+
+/**
+ * Prints usage information for the sleep builtin.
+ *
+ * @param out Output stream to write usage information to
+ */
+static void sleep_print_usage(FILE *out) {
+  sleep_args_t args;
+  build_sleep_argtable(&args);
+  fprintf(out, "Usage: sleep");
+  arg_print_syntax(out, args.argtable, "\n");
+  fprintf(out, "Pause for SECONDS.\n\n");
+  fprintf(out, "SECONDS may be a floating point number for fractional\n");
+  fprintf(out, "seconds. The shell waits itself, without starting a\n");
+  fprintf(out, "process; Ctrl-C or killing the job ends the wait with\n");
+  fprintf(out, "status 130.\n\n");
+  fprintf(out, "Options:\n");
+  arg_print_glossary(out, args.argtable, "  %-20s %s\n");
+  cleanup_sleep_argtable(&args);
+}
+
+
+/**
+ * Passes the sleep argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void sleep_describe_args(jshell_argtable_visit_fn visit,
+                                void *userdata) {
+  sleep_args_t args;
+  build_sleep_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_sleep_argtable(&args);
+}
+
+
+/**
+ * Executes the sleep builtin.
+ *
+ * @param argc Number of arguments
+ * @param argv Array of argument strings
+ * @return 0 once the time has passed, 130 if interrupted, 1 on error
+ */
+static int sleep_run(int argc, char **argv) {
+  sleep_args_t args;
+  build_sleep_argtable(&args);
+
+  int nerrors = arg_parse(argc, argv, args.argtable);
+
+  if (args.help->count > 0) {
+    sleep_print_usage(jshell_io_stdout());
+    cleanup_sleep_argtable(&args);
+    return 0;
+  }
+
+  if (nerrors > 0) {
+    arg_print_errors(stderr, args.end, "sleep");
+    fprintf(stderr, "Try 'sleep --help' for more information.\n");
+    cleanup_sleep_argtable(&args);
+    return 1;
+  }
+
+  double secs = args.seconds->dval[0];
+  cleanup_sleep_argtable(&args);
+
+  if (!(secs >= 0) || secs > SLEEP_MAX_SECONDS) {
+    fprintf(stderr, "sleep: invalid time interval '%g'\n", secs);
+    return 1;
+  }
+
+  switch (jshell_event_sleep((uint64_t)(secs * 1e9))) {
+    case JSHELL_EVENT_TIMER:
+      return 0;
+    case JSHELL_EVENT_INTERRUPTED:
+      return 130;
+    default:
+      perror("sleep");
+      return 1;
+  }
+}
+
+
+/**
+ * Command specification for the sleep builtin.
+ */
+const jshell_cmd_spec_t cmd_builtin_sleep_spec = {
+  .name = "sleep",
+  .summary = "delay for a specified amount of time",
+  .long_help = "Pause for SECONDS, which may be fractional. Runs in the "
+               "shell without starting a process; Ctrl-C or killing the "
+               "job ends it.",
+  .type = CMD_BUILTIN,
+  .run = sleep_run,
+  .print_usage = sleep_print_usage,
+  .describe_args = sleep_describe_args
+};
+
+
+/**
+ * Registers the sleep builtin with the shell command registry.
+ */
+void jshell_register_builtin_sleep_command(void) {
+  jshell_register_command(&cmd_builtin_sleep_spec);
+}
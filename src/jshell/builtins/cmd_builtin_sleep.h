@@ -0,0 +1,12 @@
+#ifndef CMD_BUILTIN_SLEEP_H
+#define CMD_BUILTIN_SLEEP_H
+
+#include "jshell/jshell_cmd_registry.h"
+
+
+extern const jshell_cmd_spec_t cmd_builtin_sleep_spec;
+
+void jshell_register_builtin_sleep_command(void);
+
+
+#endif
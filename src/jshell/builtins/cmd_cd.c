@@ -11,6 +11,9 @@
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "jshell/jshell_cwd.h"
+#include "jshell/jshell_io.h"
+#include "jshell/jshell_vars.h"
 
 
 /**
@@ -70,6 +73,20 @@ static void cd_print_usage(FILE *out) {
 }
 
 
+/**
+ * Passes the cd argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void cd_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  cd_args_t args;
+  build_cd_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_cd_argtable(&args);
+}
+
+
 /**
  * Executes the cd command.
  *
@@ -84,7 +101,7 @@ static int cd_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    cd_print_usage(stdout);
+    cd_print_usage(jshell_io_stdout());
     cleanup_cd_argtable(&args);
     return 0;
   }
@@ -101,7 +118,7 @@ static int cd_run(int argc, char **argv) {
   if (args.dir->count > 0) {
     target_dir = args.dir->filename[0];
   } else {
-    target_dir = getenv("HOME");
+    target_dir = jshell_var_get("HOME");
     if (target_dir == NULL) {
       fprintf(stderr, "cd: HOME not set\n");
       cleanup_cd_argtable(&args);
@@ -109,7 +126,7 @@ static int cd_run(int argc, char **argv) {
     }
   }
 
-  if (chdir(target_dir) != 0) {
+  if (jshell_cwd_change(target_dir) != 0) {
     fprintf(stderr, "cd: %s: %s\n", target_dir, strerror(errno));
     cleanup_cd_argtable(&args);
     return 1;
@@ -130,7 +147,8 @@ const jshell_cmd_spec_t cmd_cd_spec = {
                "the value of the HOME environment variable is used.",
   .type = CMD_BUILTIN,
   .run = cd_run,
-  .print_usage = cd_print_usage
+  .print_usage = cd_print_usage,
+  .describe_args = cd_describe_args
 };
 
 
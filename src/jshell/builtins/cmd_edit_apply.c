@@ -0,0 +1,780 @@
+/**
+ * @file cmd_edit_apply.c
+ * @brief Apply a batch of line edits to files, one pass per file
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdarg.h>
+
+#include "argtable3.h"
+#include "jshell/jshell_cmd_registry.h"
+#include "jshell/jshell_io.h"
+#include "jshell/jshell_signals.h"
+#include "utils/jbox_json.h"
+#include "utils/jbox_line_edit.h"
+#include "utils/jbox_regex.h"
+
+
+/**
+ * Command-line arguments for edit-apply command
+ */
+typedef struct {
+  struct arg_lit *help;
+  struct arg_lit *json;
+  struct arg_file *edits;
+  struct arg_end *end;
+  void *argtable[4];
+} edit_apply_args_t;
+
+
+/** Kinds of edit, named as in the batch */
+typedef enum {
+  APPLY_INSERT,
+  APPLY_REPLACE,
+  APPLY_DELETE
+} apply_kind_t;
+
+/** Outcome of one edit */
+typedef enum {
+  APPLY_PENDING,
+  APPLY_OK,
+  APPLY_ERROR,
+  APPLY_SKIPPED             /**< Another edit to the same file failed */
+} apply_status_t;
+
+/**
+ * One edit of the batch. It selects either a line by number or every
+ * line matching a regex.
+ */
+typedef struct {
+  size_t number;            /**< Position in the batch, from 1 */
+  char *file;               /**< File as given */
+  char *key;                /**< File with symlinks resolved, for grouping */
+  apply_kind_t kind;
+  long long line;           /**< Line number, or 0 if selected by match */
+  char *match;              /**< Regex selecting lines, or NULL */
+  int ignore_case;
+  char *text;               /**< Line to insert or replace with */
+  jbox_regex_t regex;
+  int compiled;
+  size_t lines;             /**< Lines inserted, replaced or deleted */
+  apply_status_t status;
+  char message[160];
+} apply_edit_t;
+
+
+/**
+ * Builds the argument table for edit-apply command.
+ * @param args Pointer to argument structure to populate
+ */
+static void build_edit_apply_argtable(edit_apply_args_t *args) {
+  args->help = arg_lit0("h", "help", "display this help and exit");
+  args->json = arg_lit0(NULL, "json", "output in JSON format");
+  args->edits = arg_file0(NULL, NULL, "EDITS",
+                          "file of edits (default: standard input)");
+  args->end = arg_end(20);
+
+  args->argtable[0] = args->help;
+  args->argtable[1] = args->json;
+  args->argtable[2] = args->edits;
+  args->argtable[3] = args->end;
+}
+
+
+/**
+ * Frees memory allocated for the argument table.
+ * @param args Pointer to argument structure to clean up
+ */
+static void cleanup_edit_apply_argtable(edit_apply_args_t *args) {
+  arg_freetable(args->argtable,
+                sizeof(args->argtable) / sizeof(args->argtable[0]));
+}
+
+
+/**
+ * Prints usage information for the edit-apply command.
+ * @param out Output stream for usage information
+ */
+static void edit_apply_print_usage(FILE *out) {
+  edit_apply_args_t args;
+  build_edit_apply_argtable(&args);
+  fprintf(out, "Usage: edit-apply");
+  arg_print_syntax(out, args.argtable, "\n");
+  fprintf(out, "Apply a batch of line edits to one or more files.\n\n");
+  fprintf(out, "EDITS is a JSON array of objects, or one object per line:\n");
+  fprintf(out, "  {\"file\": F, \"op\": \"insert\"|\"replace\"|\"delete\",\n");
+  fprintf(out, "   \"line\": N | \"match\": REGEX, \"text\": T, "
+          "\"ignore_case\": B}\n");
+  fprintf(out, "Line numbers refer to the file before any edit. Each file "
+          "is rewritten once,\nand only if all of its edits succeed.\n\n");
+  fprintf(out, "Options:\n");
+  arg_print_glossary(out, args.argtable, "  %-20s %s\n");
+  cleanup_edit_apply_argtable(&args);
+}
+
+
+/**
+ * Passes the edit-apply argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void edit_apply_describe_args(jshell_argtable_visit_fn visit,
+                                     void *userdata) {
+  edit_apply_args_t args;
+  build_edit_apply_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_edit_apply_argtable(&args);
+}
+
+
+/**
+ * Reads a whole stream into memory.
+ * @param in Stream to read
+ * @param len Set to the number of bytes read
+ * @return Allocated, NUL-terminated contents, or NULL on error
+ */
+static char *read_all(FILE *in, size_t *len) {
+  size_t cap = 4096;
+  size_t n = 0;
+  char *buf = malloc(cap);
+  if (!buf) return NULL;
+
+  size_t got;
+  while ((got = fread(buf + n, 1, cap - n - 1, in)) > 0) {
+    n += got;
+    if (n + 1 == cap) {
+      char *grown = realloc(buf, cap * 2);
+      if (!grown) {
+        free(buf);
+        return NULL;
+      }
+      buf = grown;
+      cap *= 2;
+    }
+  }
+  if (ferror(in)) {
+    free(buf);
+    return NULL;
+  }
+  buf[n] = '\0';
+  *len = n;
+  return buf;
+}
+
+
+/**
+ * Records why an edit failed.
+ * @param e Edit
+ * @param fmt printf-style format of the message
+ * @return -1, for returning straight from the caller
+ */
+__attribute__((format(printf, 2, 3)))
+static int edit_fail(apply_edit_t *e, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(e->message, sizeof(e->message), fmt, ap);
+  va_end(ap);
+  e->status = APPLY_ERROR;
+  return -1;
+}
+
+
+/**
+ * Reads the members of one edit object, its OBJECT_BEGIN already read,
+ * and checks that they make a complete edit.
+ * @param r Reader
+ * @param e Edit to fill in (zeroed, with number set)
+ * @return 0 on success, -1 on error (message set in e)
+ */
+static int parse_edit(jbox_json_reader_t *r, apply_edit_t *e) {
+  int have_kind = 0;
+  jbox_json_event_t ev;
+
+  while ((ev = jbox_json_next(r)) == JBOX_JSON_KEY) {
+    if (strcmp(r->text, "file") == 0) {
+      free(e->file);
+      if (!(e->file = jbox_json_read_string(r))) {
+        return edit_fail(e, "\"file\" must be a string");
+      }
+    } else if (strcmp(r->text, "op") == 0) {
+      char *op = jbox_json_read_string(r);
+      have_kind = 1;
+      if (op && strcmp(op, "insert") == 0) {
+        e->kind = APPLY_INSERT;
+      } else if (op && strcmp(op, "replace") == 0) {
+        e->kind = APPLY_REPLACE;
+      } else if (op && strcmp(op, "delete") == 0) {
+        e->kind = APPLY_DELETE;
+      } else {
+        have_kind = 0;
+      }
+      free(op);
+      if (!have_kind) {
+        return edit_fail(e, "\"op\" must be insert, replace or delete");
+      }
+    } else if (strcmp(r->text, "line") == 0) {
+      if (!jbox_json_read_int(r, &e->line) || e->line < 1) {
+        return edit_fail(e, "\"line\" must be a number >= 1");
+      }
+    } else if (strcmp(r->text, "match") == 0) {
+      free(e->match);
+      if (!(e->match = jbox_json_read_string(r))) {
+        return edit_fail(e, "\"match\" must be a string");
+      }
+    } else if (strcmp(r->text, "text") == 0) {
+      free(e->text);
+      if (!(e->text = jbox_json_read_string(r))) {
+        return edit_fail(e, "\"text\" must be a string");
+      }
+    } else if (strcmp(r->text, "ignore_case") == 0) {
+      ev = jbox_json_next(r);
+      if (ev != JBOX_JSON_TRUE && ev != JBOX_JSON_FALSE) {
+        return edit_fail(e, "\"ignore_case\" must be true or false");
+      }
+      e->ignore_case = ev == JBOX_JSON_TRUE;
+    } else if (jbox_json_skip(r, jbox_json_next(r)) != 0) {
+      return edit_fail(e, "invalid JSON");
+    }
+  }
+  if (ev != JBOX_JSON_OBJECT_END) {
+    return edit_fail(e, "invalid JSON");
+  }
+
+  if (!e->file) return edit_fail(e, "missing \"file\"");
+  if (!have_kind) return edit_fail(e, "missing \"op\"");
+  if ((e->line > 0) == (e->match != NULL)) {
+    return edit_fail(e, "exactly one of \"line\" and \"match\" is needed");
+  }
+  if (e->kind != APPLY_DELETE && !e->text) {
+    return edit_fail(e, "missing \"text\"");
+  }
+
+  if (e->match) {
+    int cflags = REG_EXTENDED | (e->ignore_case ? REG_ICASE : 0);
+    int ret = jbox_regex_compile(&e->regex, e->match, cflags);
+    if (ret != 0) {
+      char errbuf[128];
+      jbox_regex_error(ret, &e->regex, errbuf, sizeof(errbuf));
+      return edit_fail(e, "invalid regex: %s", errbuf);
+    }
+    e->compiled = 1;
+  }
+
+  e->key = realpath(e->file, NULL);
+  if (!e->key && !(e->key = strdup(e->file))) {
+    return edit_fail(e, "memory allocation failed");
+  }
+  return 0;
+}
+
+
+/**
+ * Frees the fields of the edits and the array.
+ * @param edits Edits
+ * @param count Number of edits
+ */
+static void free_edits(apply_edit_t *edits, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    free(edits[i].file);
+    free(edits[i].key);
+    free(edits[i].match);
+    free(edits[i].text);
+    if (edits[i].compiled) jbox_regex_free(&edits[i].regex);
+  }
+  free(edits);
+}
+
+
+/**
+ * Appends an empty edit to the batch.
+ * @param edits Batch, reallocated as needed
+ * @param count Number of edits, incremented
+ * @param cap Capacity of the batch
+ * @return The new edit, or NULL if out of memory
+ */
+static apply_edit_t *add_edit(apply_edit_t **edits, size_t *count,
+                              size_t *cap) {
+  if (*count == *cap) {
+    size_t grown_cap = *cap ? *cap * 2 : 16;
+    apply_edit_t *grown = realloc(*edits, grown_cap * sizeof(**edits));
+    if (!grown) return NULL;
+    *edits = grown;
+    *cap = grown_cap;
+  }
+  apply_edit_t *e = &(*edits)[(*count)++];
+  memset(e, 0, sizeof(*e));
+  e->number = *count;
+  return e;
+}
+
+
+/**
+ * Parses a batch of edits: a JSON array of edit objects, or one object
+ * per line (NDJSON).
+ * @param doc Batch text
+ * @param len Length of doc
+ * @param edits Set to the edits read, even on error
+ * @param count Set to the number of edits read
+ * @param error Set to the message on error
+ * @param error_len Size of error
+ * @return 0 on success, -1 on error
+ */
+static int parse_edits(const char *doc, size_t len, apply_edit_t **edits,
+                       size_t *count, char *error, size_t error_len) {
+  size_t cap = 0;
+  *edits = NULL;
+  *count = 0;
+
+  const char *p = doc;
+  const char *end = doc + len;
+  while (p < end && strchr(" \t\r\n", *p)) p++;
+
+  if (p < end && *p == '[') {
+    jbox_json_reader_t r;
+    jbox_json_reader_init(&r, p, (size_t)(end - p));
+    jbox_json_event_t ev = jbox_json_next(&r);
+    while ((ev = jbox_json_next(&r)) == JBOX_JSON_OBJECT_BEGIN) {
+      apply_edit_t *e = add_edit(edits, count, &cap);
+      if (!e) {
+        snprintf(error, error_len, "memory allocation failed");
+        jbox_json_reader_free(&r);
+        return -1;
+      }
+      if (parse_edit(&r, e) != 0) {
+        snprintf(error, error_len, "edit %zu: %s", e->number, e->message);
+        jbox_json_reader_free(&r);
+        return -1;
+      }
+    }
+    int ok = ev == JBOX_JSON_ARRAY_END && jbox_json_next(&r) == JBOX_JSON_DONE;
+    jbox_json_reader_free(&r);
+    if (!ok) {
+      snprintf(error, error_len, "edit %zu: expected an object",
+               *count + 1);
+      return -1;
+    }
+    return 0;
+  }
+
+  while (p < end) {
+    const char *nl = memchr(p, '\n', (size_t)(end - p));
+    const char *line_end = nl ? nl : end;
+    const char *q = p;
+    while (q < line_end && strchr(" \t\r", *q)) q++;
+
+    if (q < line_end) {
+      apply_edit_t *e = add_edit(edits, count, &cap);
+      if (!e) {
+        snprintf(error, error_len, "memory allocation failed");
+        return -1;
+      }
+      jbox_json_reader_t r;
+      jbox_json_reader_init(&r, q, (size_t)(line_end - q));
+      int rc = -1;
+      if (jbox_json_next(&r) != JBOX_JSON_OBJECT_BEGIN) {
+        edit_fail(e, "expected an object");
+      } else if ((rc = parse_edit(&r, e)) == 0 &&
+                 jbox_json_next(&r) != JBOX_JSON_DONE) {
+        rc = edit_fail(e, "invalid JSON");
+      }
+      jbox_json_reader_free(&r);
+      if (rc != 0) {
+        snprintf(error, error_len, "edit %zu: %s", e->number, e->message);
+        return -1;
+      }
+    }
+    p = line_end + 1;
+  }
+  return 0;
+}
+
+
+/**
+ * Orders edits by file, then by position in the batch.
+ */
+static int compare_by_file(const void *a, const void *b) {
+  const apply_edit_t *x = *(apply_edit_t *const *)a;
+  const apply_edit_t *y = *(apply_edit_t *const *)b;
+  int c = strcmp(x->key, y->key);
+  if (c != 0) return c;
+  return (x->number > y->number) - (x->number < y->number);
+}
+
+
+/**
+ * Orders edits by line, then by position in the batch.
+ */
+static int compare_by_line(const void *a, const void *b) {
+  const apply_edit_t *x = *(apply_edit_t *const *)a;
+  const apply_edit_t *y = *(apply_edit_t *const *)b;
+  if (x->line != y->line) return x->line < y->line ? -1 : 1;
+  return (x->number > y->number) - (x->number < y->number);
+}
+
+
+/**
+ * Applies one edit to the current line: writes an inserted line, or
+ * claims the line for a replacement or deletion.
+ * @param ed Editor
+ * @param e Edit
+ * @param owner Edit that already claimed the line, updated
+ * @param n Line number
+ * @return 0 on success, -1 on a write error (errno set), -2 on conflict
+ */
+static int apply_to_line(jbox_line_edit_t *ed, apply_edit_t *e,
+                         apply_edit_t **owner, size_t n) {
+  if (e->kind == APPLY_INSERT) {
+    if (jbox_line_edit_write_line(ed, e->text, strlen(e->text)) < 0) {
+      return -1;
+    }
+    e->lines++;
+    return 0;
+  }
+  if (*owner) {
+    edit_fail(e, "line %zu is already changed by edit %zu", n,
+              (*owner)->number);
+    return -2;
+  }
+  *owner = e;
+  return 0;
+}
+
+
+/**
+ * Applies the edits to one file in a single pass, rewriting it only if
+ * they all succeed.
+ *
+ * Edits by line number are sorted by line and met in order as the file
+ * streams past; edits by regex are tried on every line. Once no edit
+ * remains to be met the rest of the file is copied in blocks.
+ *
+ * @param group Edits to the file, in batch order
+ * @param count Number of edits
+ * @return 0 on success, -1 on error (the file is left as it was and the
+ *         failing edit has its message), 1 if interrupted
+ */
+static int apply_file(apply_edit_t **group, size_t count) {
+  const char *path = group[0]->file;
+  apply_edit_t **by_line = malloc(count * sizeof(*by_line));
+  apply_edit_t **by_match = malloc(count * sizeof(*by_match));
+  if (!by_line || !by_match) {
+    free(by_line);
+    free(by_match);
+    return edit_fail(group[0], "memory allocation failed");
+  }
+  size_t n_line = 0, n_match = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (group[i]->match) {
+      by_match[n_match++] = group[i];
+    } else {
+      by_line[n_line++] = group[i];
+    }
+  }
+  qsort(by_line, n_line, sizeof(*by_line), compare_by_line);
+
+  jbox_line_edit_t ed;
+  if (jbox_line_edit_open(&ed, path) != 0) {
+    for (size_t i = 0; i < count; i++) {
+      edit_fail(group[i], "%s", strerror(errno));
+    }
+    free(by_line);
+    free(by_match);
+    return -1;
+  }
+
+  int result = 0;
+  int changed = 0;
+  size_t next = 0;
+  size_t n = 0;
+  const char *line;
+  size_t len;
+  int rc;
+
+  while ((rc = jbox_line_edit_next(&ed, &line, &len)) == 1) {
+    n++;
+    if (jshell_is_interrupted()) {
+      result = 1;
+      break;
+    }
+
+    /* Edits meeting this line, merged back into batch order */
+    size_t first = next;
+    while (next < n_line && (size_t)by_line[next]->line == n) next++;
+
+    apply_edit_t *owner = NULL;
+    size_t i = first, j = 0;
+    for (;;) {
+      while (j < n_match &&
+             jbox_regex_exec(&by_match[j]->regex, line, len, NULL) != 0) {
+        j++;
+      }
+      apply_edit_t *e;
+      if (i < next &&
+          (j == n_match || by_line[i]->number < by_match[j]->number)) {
+        e = by_line[i++];
+      } else if (j < n_match) {
+        e = by_match[j++];
+      } else {
+        break;
+      }
+      rc = apply_to_line(&ed, e, &owner, n);
+      if (rc != 0) break;
+      changed = 1;
+    }
+    if (rc == -2) {
+      result = -1;
+      break;
+    }
+    if (rc < 0) break;
+
+    if (!owner) {
+      rc = jbox_line_edit_write_line(&ed, line, len);
+    } else {
+      owner->lines++;
+      if (owner->kind == APPLY_REPLACE) {
+        rc = jbox_line_edit_write_line(&ed, owner->text, strlen(owner->text));
+      }
+    }
+    if (rc < 0) break;
+
+    if (next == n_line && n_match == 0) {
+      rc = jbox_line_edit_copy_rest(&ed);
+      break;
+    }
+  }
+
+  if (rc < 0 && result == 0) {
+    edit_fail(group[0], "%s", strerror(errno));
+    result = -1;
+  }
+
+  /* Past the last line only appending is possible */
+  for (; result == 0 && next < n_line; next++) {
+    apply_edit_t *e = by_line[next];
+    if (e->kind != APPLY_INSERT || (size_t)e->line != n + 1) {
+      edit_fail(e, "line %lld exceeds file length (%zu lines)", e->line, n);
+      result = -1;
+    } else if (jbox_line_edit_write_line(&ed, e->text, strlen(e->text)) < 0) {
+      edit_fail(e, "%s", strerror(errno));
+      result = -1;
+    } else {
+      e->lines++;
+      changed = 1;
+    }
+  }
+
+  /* The original is only replaced when something changed */
+  if (result == 0 && changed) {
+    if (jbox_line_edit_commit(&ed) != 0) {
+      edit_fail(group[0], "%s", strerror(errno));
+      result = -1;
+    }
+  } else {
+    jbox_line_edit_abort(&ed);
+  }
+
+  for (size_t k = 0; k < count; k++) {
+    if (group[k]->status == APPLY_PENDING) {
+      group[k]->status = result == 0 ? APPLY_OK : APPLY_SKIPPED;
+    }
+  }
+  free(by_line);
+  free(by_match);
+  return result;
+}
+
+
+/**
+ * Prints the outcome of every edit as one JSON object.
+ * @param edits Edits, in batch order
+ * @param count Number of edits
+ * @param status Overall status ("ok", "error" or "interrupted")
+ */
+static void print_json_results(const apply_edit_t *edits, size_t count,
+                               const char *status) {
+  static const char *const kinds[] = {"insert", "replace", "delete"};
+  static const char *const statuses[] = {"skipped", "ok", "error",
+                                         "skipped"};
+  jbox_json_writer_t w;
+  jbox_json_writer_init(&w, jshell_io_stdout(), false);
+  jbox_json_begin_object(&w);
+  jbox_json_key(&w, "status");
+  jbox_json_string(&w, status);
+  jbox_json_key(&w, "edits");
+  jbox_json_begin_array(&w);
+  for (size_t i = 0; i < count; i++) {
+    const apply_edit_t *e = &edits[i];
+    jbox_json_begin_object(&w);
+    jbox_json_key(&w, "edit");
+    jbox_json_int(&w, (long long)e->number);
+    jbox_json_key(&w, "path");
+    jbox_json_string(&w, e->file);
+    jbox_json_key(&w, "op");
+    jbox_json_string(&w, kinds[e->kind]);
+    jbox_json_key(&w, "status");
+    jbox_json_string(&w, statuses[e->status]);
+    if (e->status == APPLY_ERROR) {
+      jbox_json_key(&w, "message");
+      jbox_json_string(&w, e->message);
+    } else if (e->status == APPLY_OK) {
+      jbox_json_key(&w, "lines");
+      jbox_json_int(&w, (long long)e->lines);
+    }
+    jbox_json_end_object(&w);
+  }
+  jbox_json_end_array(&w);
+  jbox_json_end_object(&w);
+  fputc('\n', jshell_io_stdout());
+}
+
+
+/**
+ * Prints an error that stopped the batch before any file was edited.
+ * @param show_json Whether to print JSON
+ * @param message Error message
+ */
+static void print_batch_error(int show_json, const char *message) {
+  if (show_json) {
+    FILE *out = jshell_io_stdout();
+    fputs("{\"status\": \"error\", \"message\": ", out);
+    jbox_json_write_string(out, message);
+    fputs("}\n", out);
+  } else {
+    fprintf(stderr, "edit-apply: %s\n", message);
+  }
+}
+
+
+/**
+ * Main entry point for the edit-apply command.
+ * @param argc Argument count
+ * @param argv Argument vector
+ * @return 0 on success, non-zero on error, 130 if interrupted
+ */
+static int edit_apply_run(int argc, char **argv) {
+  edit_apply_args_t args;
+  build_edit_apply_argtable(&args);
+
+  int nerrors = arg_parse(argc, argv, args.argtable);
+
+  if (args.help->count > 0) {
+    edit_apply_print_usage(jshell_io_stdout());
+    cleanup_edit_apply_argtable(&args);
+    return 0;
+  }
+
+  if (nerrors > 0) {
+    arg_print_errors(stderr, args.end, "edit-apply");
+    fprintf(stderr, "Try 'edit-apply --help' for more information.\n");
+    cleanup_edit_apply_argtable(&args);
+    return 1;
+  }
+
+  int show_json = args.json->count > 0;
+  const char *source = args.edits->count > 0 &&
+                       strcmp(args.edits->filename[0], "-") != 0
+                       ? args.edits->filename[0] : NULL;
+
+  size_t doc_len = 0;
+  char *doc = NULL;
+  if (source) {
+    FILE *in = fopen(source, "r");
+    if (in) {
+      doc = read_all(in, &doc_len);
+      fclose(in);
+    }
+  } else {
+    doc = read_all(jshell_io_stdin(), &doc_len);
+  }
+  if (!doc) {
+    char message[512];
+    snprintf(message, sizeof(message), "%s: %s",
+             source ? source : "standard input", strerror(errno));
+    print_batch_error(show_json, message);
+    cleanup_edit_apply_argtable(&args);
+    return 1;
+  }
+
+  apply_edit_t *edits;
+  size_t count;
+  char error[256];
+  int rc = parse_edits(doc, doc_len, &edits, &count, error, sizeof(error));
+  free(doc);
+  if (rc != 0) {
+    print_batch_error(show_json, error);
+    free_edits(edits, count);
+    cleanup_edit_apply_argtable(&args);
+    return 1;
+  }
+
+  /* Group the edits by file, keeping batch order within each */
+  apply_edit_t **order = malloc((count ? count : 1) * sizeof(*order));
+  if (!order) {
+    print_batch_error(show_json, "memory allocation failed");
+    free_edits(edits, count);
+    cleanup_edit_apply_argtable(&args);
+    return 1;
+  }
+  for (size_t i = 0; i < count; i++) order[i] = &edits[i];
+  qsort(order, count, sizeof(*order), compare_by_file);
+
+  int failed = 0, interrupted = 0;
+  for (size_t start = 0; start < count && !interrupted;) {
+    size_t stop = start + 1;
+    while (stop < count && strcmp(order[stop]->key, order[start]->key) == 0) {
+      stop++;
+    }
+    rc = apply_file(order + start, stop - start);
+    if (rc < 0) failed = 1;
+    if (rc > 0) interrupted = 1;
+    start = stop;
+  }
+  free(order);
+
+  if (show_json) {
+    print_json_results(edits, count, interrupted ? "interrupted"
+                                     : failed ? "error" : "ok");
+  } else {
+    for (size_t i = 0; i < count; i++) {
+      if (edits[i].status == APPLY_ERROR) {
+        fprintf(stderr, "edit-apply: %s: edit %zu: %s\n", edits[i].file,
+                edits[i].number, edits[i].message);
+      }
+    }
+    if (interrupted) fprintf(stderr, "edit-apply: interrupted\n");
+  }
+
+  free_edits(edits, count);
+  cleanup_edit_apply_argtable(&args);
+  if (interrupted) return 130;  /* 128 + SIGINT(2) */
+  return failed ? 1 : 0;
+}
+
+
+/**
+ * Command specification for edit-apply
+ */
+const jshell_cmd_spec_t cmd_edit_apply_spec = {
+  .name = "edit-apply",
+  .summary = "apply a batch of line edits to files",
+  .long_help = "Apply the insert, replace and delete edits listed in EDITS "
+               "(a JSON array or NDJSON), selecting lines by number or "
+               "regex. Each file is rewritten once, in a single pass, "
+               "and only if all of its edits succeed.",
+  .type = CMD_BUILTIN,
+  .run = edit_apply_run,
+  .print_usage = edit_apply_print_usage,
+  .describe_args = edit_apply_describe_args
+};
+
+
+/**
+ * Registers the edit-apply command with the shell command registry.
+ */
+void jshell_register_edit_apply_command(void) {
+  jshell_register_command(&cmd_edit_apply_spec);
+}
@@ -0,0 +1,10 @@
+#ifndef CMD_EDIT_APPLY_H
+#define CMD_EDIT_APPLY_H
+
+#include "jshell/jshell_cmd_registry.h"
+
+extern const jshell_cmd_spec_t cmd_edit_apply_spec;
+
+void jshell_register_edit_apply_command(void);
+
+#endif /* CMD_EDIT_APPLY_H */
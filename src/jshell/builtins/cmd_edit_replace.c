@@ -3,16 +3,31 @@
  * @brief Global find/replace with regex in a file command implementation
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
-#include <regex.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "jshell/jshell_io.h"
 #include "jshell/jshell_signals.h"
+#include "utils/jbox_json.h"
+#include "utils/jbox_line_edit.h"
+#include "utils/jbox_regex.h"
+
+
+/** Most positional arguments; longer file lists go on stdin */
+#define EDIT_REPLACE_MAX_ARGS 4096
+
+/** Most worker threads editing files at once */
+#define EDIT_REPLACE_MAX_WORKERS 64
 
 
 /**
@@ -23,11 +38,12 @@ typedef struct {
   struct arg_lit *case_insensitive;
   struct arg_lit *fixed_strings;
   struct arg_lit *json;
-  struct arg_file *file;
-  struct arg_str *pattern;
-  struct arg_str *replacement;
+  struct arg_lit *count_only;
+  struct arg_int *max_replacements;
+  struct arg_lit *files;
+  struct arg_str *args;
   struct arg_end *end;
-  void *argtable[8];
+  void *argtable[9];
 } edit_replace_args_t;
 
 
@@ -41,19 +57,26 @@ static void build_edit_replace_argtable(edit_replace_args_t *args) {
   args->fixed_strings = arg_lit0(NULL, "fixed-strings",
                                   "treat pattern as literal string");
   args->json = arg_lit0(NULL, "json", "output in JSON format");
-  args->file = arg_file1(NULL, NULL, "FILE", "file to edit");
-  args->pattern = arg_str1(NULL, NULL, "PATTERN", "search pattern (regex)");
-  args->replacement = arg_str1(NULL, NULL, "REPLACEMENT", "replacement text");
+  args->count_only = arg_lit0(NULL, "count-only",
+                              "count matches without changing the file");
+  args->max_replacements = arg_int0(NULL, "max-replacements", "N",
+                                    "stop after N replacements in a file");
+  args->files = arg_lit0(NULL, "files",
+                         "take PATTERN REPLACEMENT FILE..., or the file "
+                         "names on stdin if none are given");
+  args->args = arg_strn(NULL, NULL, "ARG", 2, EDIT_REPLACE_MAX_ARGS,
+                        "FILE PATTERN REPLACEMENT, or see --files");
   args->end = arg_end(20);
 
   args->argtable[0] = args->help;
   args->argtable[1] = args->case_insensitive;
   args->argtable[2] = args->fixed_strings;
   args->argtable[3] = args->json;
-  args->argtable[4] = args->file;
-  args->argtable[5] = args->pattern;
-  args->argtable[6] = args->replacement;
-  args->argtable[7] = args->end;
+  args->argtable[4] = args->count_only;
+  args->argtable[5] = args->max_replacements;
+  args->argtable[6] = args->files;
+  args->argtable[7] = args->args;
+  args->argtable[8] = args->end;
 }
 
 
@@ -74,9 +97,12 @@ static void cleanup_edit_replace_argtable(edit_replace_args_t *args) {
 static void edit_replace_print_usage(FILE *out) {
   edit_replace_args_t args;
   build_edit_replace_argtable(&args);
-  fprintf(out, "Usage: edit-replace");
-  arg_print_syntax(out, args.argtable, "\n");
+  fprintf(out, "Usage: edit-replace [OPTIONS] FILE PATTERN REPLACEMENT\n");
+  fprintf(out, "       edit-replace [OPTIONS] --files PATTERN REPLACEMENT "
+          "[FILE]...\n");
   fprintf(out, "Global find/replace with regex in a file.\n\n");
+  fprintf(out, "With --files, the files are edited in parallel, one worker "
+          "per core.\n\n");
   fprintf(out, "Options:\n");
   arg_print_glossary(out, args.argtable, "  %-20s %s\n");
   cleanup_edit_replace_argtable(&args);
@@ -84,36 +110,17 @@ static void edit_replace_print_usage(FILE *out) {
 
 
 /**
- * Escapes special characters in a string for JSON output.
- * @param str Input string to escape
- * @param out Output buffer for escaped string
- * @param out_size Size of output buffer
+ * Passes the edit-replace argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
  */
-static void escape_json_string(const char *str, char *out, size_t out_size) {
-  size_t j = 0;
-  for (size_t i = 0; str[i] && j < out_size - 1; i++) {
-    char c = str[i];
-    if (c == '"' || c == '\\') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = c;
-    } else if (c == '\n') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = 'n';
-    } else if (c == '\r') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = 'r';
-    } else if (c == '\t') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = 't';
-    } else {
-      out[j++] = c;
-    }
-  }
-  out[j] = '\0';
+static void edit_replace_describe_args(jshell_argtable_visit_fn visit,
+                                       void *userdata) {
+  edit_replace_args_t args;
+  build_edit_replace_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_edit_replace_argtable(&args);
 }
 
 
@@ -128,281 +135,357 @@ static void escape_json_string(const char *str, char *out, size_t out_size) {
 static void print_json_result(const char *path, const char *status,
                               int matches, int replacements,
                               const char *message) {
-  char escaped_path[512];
-  escape_json_string(path, escaped_path, sizeof(escaped_path));
-
+  FILE *out = jshell_io_stdout();
+  fputs("{\"path\": ", out);
+  jbox_json_write_string(out, path);
+  fprintf(out, ", \"status\": \"%s\"", status);
   if (message) {
-    char escaped_msg[512];
-    escape_json_string(message, escaped_msg, sizeof(escaped_msg));
-    printf("{\"path\": \"%s\", \"status\": \"%s\", \"message\": \"%s\"}\n",
-           escaped_path, status, escaped_msg);
+    fputs(", \"message\": ", out);
+    jbox_json_write_string(out, message);
   } else {
-    printf("{\"path\": \"%s\", \"status\": \"%s\", "
-           "\"matches\": %d, \"replacements\": %d}\n",
-           escaped_path, status, matches, replacements);
+    fprintf(out, ", \"matches\": %d, \"replacements\": %d",
+            matches, replacements);
   }
+  fputs("}\n", out);
 }
 
 
 /**
- * Replaces all occurrences of a literal string with another string.
- * @param str Input string to search
- * @param old String to find
- * @param new_str Replacement string
- * @param case_insensitive Whether to perform case-insensitive matching
- * @param count Output parameter for number of replacements made
- * @return Newly allocated string with replacements, or NULL on error
+ * What to replace, and how, in every line of the file.
  */
-static char *str_replace_literal(const char *str, const char *old,
-                                  const char *new_str, int case_insensitive,
-                                  int *count) {
-  size_t old_len = strlen(old);
-  size_t new_len = strlen(new_str);
-  *count = 0;
-
-  if (old_len == 0) {
-    return strdup(str);
-  }
+typedef struct {
+  jbox_regex_t *regex;      /**< Compiled pattern, or NULL for a literal */
+  const char *pattern;      /**< Literal to find */
+  size_t pattern_len;
+  const char *replacement;
+  size_t replacement_len;
+  int case_insensitive;     /**< For the literal; the regex has REG_ICASE */
+  int count_only;           /**< Count matches without writing anything */
+  long left;                /**< Replacements still allowed, -1 for any */
+} replace_spec_t;
 
-  // Count occurrences
-  const char *p = str;
-  int num_matches = 0;
-  while (*p) {
-    int match;
-    if (case_insensitive) {
-      match = (strncasecmp(p, old, old_len) == 0);
-    } else {
-      match = (strncmp(p, old, old_len) == 0);
-    }
-    if (match) {
-      num_matches++;
-      p += old_len;
-    } else {
-      p++;
+
+/**
+ * Finds a literal string in a line.
+ *
+ * memmem() and memchr() compare a vector at a time, so the search for
+ * the first byte of the literal does most of the work; a case-insensitive
+ * search looks for the first byte in both cases.
+ *
+ * @param hay Text to search
+ * @param len Length of hay
+ * @param needle Literal to find, at least one byte
+ * @param needle_len Length of needle
+ * @param case_insensitive Whether case is ignored
+ * @return Start of the first occurrence, or NULL if there is none
+ */
+static const char *find_literal(const char *hay, size_t len,
+                                const char *needle, size_t needle_len,
+                                int case_insensitive) {
+  if (!case_insensitive) return memmem(hay, len, needle, needle_len);
+
+  int lower = tolower((unsigned char)needle[0]);
+  int upper = toupper((unsigned char)needle[0]);
+  const char *end = hay + len;
+  while ((size_t)(end - hay) >= needle_len) {
+    size_t span = (size_t)(end - hay) - needle_len + 1;
+    const char *p = memchr(hay, lower, span);
+    if (lower != upper) {
+      const char *q = memchr(hay, upper, p ? (size_t)(p - hay) : span);
+      if (q) p = q;
     }
+    if (!p) return NULL;
+    if (strncasecmp(p + 1, needle + 1, needle_len - 1) == 0) return p;
+    hay = p + 1;
   }
+  return NULL;
+}
 
-  if (num_matches == 0) {
-    return strdup(str);
-  }
 
-  // Allocate result
-  size_t result_len = strlen(str) + num_matches * (new_len - old_len);
-  char *result = malloc(result_len + 1);
-  if (!result) return NULL;
-
-  // Build result
-  char *dst = result;
-  p = str;
-  while (*p) {
-    int match;
-    if (case_insensitive) {
-      match = (strncasecmp(p, old, old_len) == 0);
+/**
+ * Replaces the matches in one line in a single pass, writing the text
+ * between them and the replacements straight to the new file.
+ * @param ed Editor
+ * @param rs What to replace; its count of replacements left is updated
+ * @param line Line, without its newline
+ * @param len Length of line
+ * @param matches Incremented for every match
+ * @return 0 on success, -1 on a write error (errno set)
+ */
+static int replace_line(jbox_line_edit_t *ed, replace_spec_t *rs,
+                        const char *line, size_t len, int *matches) {
+  size_t pos = 0;
+  size_t done = 0;          /* Start of the text not yet written */
+
+  while (pos < len && rs->left != 0) {
+    size_t so, eo;
+    if (rs->regex) {
+      regmatch_t m;
+      if (jbox_regex_exec_at(rs->regex, line, len, pos, &m) != 0) break;
+      so = (size_t)m.rm_so;
+      eo = (size_t)m.rm_eo;
     } else {
-      match = (strncmp(p, old, old_len) == 0);
+      if (rs->pattern_len == 0) break;
+      const char *hit = find_literal(line + pos, len - pos, rs->pattern,
+                                     rs->pattern_len, rs->case_insensitive);
+      if (!hit) break;
+      so = (size_t)(hit - line);
+      eo = so + rs->pattern_len;
     }
-    if (match) {
-      memcpy(dst, new_str, new_len);
-      dst += new_len;
-      p += old_len;
-      (*count)++;
-    } else {
-      *dst++ = *p++;
+
+    (*matches)++;
+    if (rs->left > 0) rs->left--;
+    if (!rs->count_only &&
+        (jbox_line_edit_write(ed, line + done, so - done) != 0 ||
+         jbox_line_edit_write(ed, rs->replacement,
+                              rs->replacement_len) != 0)) {
+      return -1;
     }
+    done = eo;
+    /* An empty match leaves the next byte to the following span */
+    pos = so == eo ? eo + 1 : eo;
   }
-  *dst = '\0';
 
-  return result;
+  if (rs->count_only) return 0;
+  return jbox_line_edit_write_line(ed, line + done, len - done);
 }
 
 
 /**
- * Replaces all matches of a compiled regex pattern with a replacement string.
- * @param str Input string to search
- * @param regex Compiled regex pattern
- * @param replacement Replacement string
- * @param count Output parameter for number of replacements made
- * @return Newly allocated string with replacements, or NULL on error
+ * Outcome of replacing in one file.
  */
-static char *str_replace_regex(const char *str, regex_t *regex,
-                                const char *replacement, int *count) {
-  *count = 0;
-  regmatch_t match;
-  size_t repl_len = strlen(replacement);
-
-  // First pass: count matches and calculate result size
-  const char *p = str;
-  size_t result_size = 0;
-  int num_matches = 0;
-
-  while (*p && regexec(regex, p, 1, &match, 0) == 0) {
-    result_size += match.rm_so;  // Text before match
-    result_size += repl_len;     // Replacement text
-    p += match.rm_eo;
-    num_matches++;
-    if (match.rm_so == match.rm_eo) {
-      // Zero-length match - advance by one to avoid infinite loop
-      if (*p) {
-        result_size++;
-        p++;
-      } else {
-        break;
-      }
-    }
-  }
-  result_size += strlen(p);  // Remaining text
+typedef struct {
+  const char *path;
+  int matches;
+  int replacements;
+  int status;               /**< 0 done, -1 error, 1 interrupted, 2 not run */
+  int err;                  /**< errno of the error */
+} replace_result_t;
+
 
-  if (num_matches == 0) {
-    return strdup(str);
+/**
+ * Replaces the matches in one file, streaming it through the line editor.
+ * The file is only rewritten if something was replaced.
+ * @param rs What to replace; a copy, so the limit applies per file
+ * @param res Outcome, with path set
+ */
+static void replace_file(replace_spec_t rs, replace_result_t *res) {
+  /* Counting needs no temporary file */
+  jbox_line_edit_t ed;
+  int rc = rs.count_only ? jbox_line_edit_open_read(&ed, res->path)
+                         : jbox_line_edit_open(&ed, res->path);
+  if (rc != 0) {
+    res->status = -1;
+    res->err = errno;
+    return;
   }
 
-  // Allocate result
-  char *result = malloc(result_size + 1);
-  if (!result) return NULL;
-
-  // Second pass: build result
-  char *dst = result;
-  p = str;
-
-  while (*p && regexec(regex, p, 1, &match, 0) == 0) {
-    // Copy text before match
-    memcpy(dst, p, match.rm_so);
-    dst += match.rm_so;
-    // Copy replacement
-    memcpy(dst, replacement, repl_len);
-    dst += repl_len;
-    p += match.rm_eo;
-    (*count)++;
-    if (match.rm_so == match.rm_eo) {
-      // Zero-length match - copy one char and advance
-      if (*p) {
-        *dst++ = *p++;
-      } else {
-        break;
-      }
+  const char *line;
+  size_t line_len;
+  while ((rc = jbox_line_edit_next(&ed, &line, &line_len)) == 1) {
+    /* Check for interruption during replacement */
+    if (jshell_is_interrupted()) {
+      jbox_line_edit_abort(&ed);
+      res->replacements = rs.count_only ? 0 : res->matches;
+      res->status = 1;
+      return;
+    }
+    if (replace_line(&ed, &rs, line, line_len, &res->matches) != 0) {
+      rc = -1;
+      break;
+    }
+    if (rs.left == 0) {
+      /* The limit is reached; the rest is copied as it is */
+      rc = rs.count_only ? 0 : jbox_line_edit_copy_rest(&ed);
+      break;
     }
   }
-  // Copy remaining text
-  strcpy(dst, p);
+  res->replacements = rs.count_only ? 0 : res->matches;
 
-  return result;
+  /* The original is only replaced when something changed */
+  if (rc == 0 && res->replacements > 0) {
+    rc = jbox_line_edit_commit(&ed);
+  } else {
+    int saved = errno;
+    jbox_line_edit_abort(&ed);
+    errno = saved;
+  }
+  if (rc != 0) {
+    res->status = -1;
+    res->err = errno;
+    res->replacements = 0;
+    return;
+  }
+  res->status = 0;
 }
 
 
 /**
- * Dynamic buffer for storing lines of text from a file
+ * Files shared out among worker threads.
  */
 typedef struct {
-  char **lines;
+  const replace_spec_t *spec;
+  int cflags;               /**< Flags to compile each worker's regex with */
+  replace_result_t *results;
   size_t count;
-  size_t capacity;
-} line_buffer_t;
+  size_t next;              /**< Next file to hand out */
+  pthread_mutex_t lock;
+} replace_pool_t;
 
 
 /**
- * Initializes a line buffer to empty state.
- * @param buf Pointer to line buffer to initialize
+ * Worker thread: takes files from the pool until none are left. A regex
+ * cannot be shared between threads, so each worker compiles its own.
+ * @param arg The pool
+ * @return NULL
  */
-static void line_buffer_init(line_buffer_t *buf) {
-  buf->lines = NULL;
-  buf->count = 0;
-  buf->capacity = 0;
-}
-
+static void *replace_worker(void *arg) {
+  replace_pool_t *pool = arg;
+  replace_spec_t rs = *pool->spec;
+  jbox_regex_t regex;
+  if (rs.regex) {
+    if (jbox_regex_compile(&regex, rs.pattern, pool->cflags) != 0) {
+      return NULL;
+    }
+    rs.regex = &regex;
+  }
 
-/**
- * Frees all memory associated with a line buffer.
- * @param buf Pointer to line buffer to free
- */
-static void line_buffer_free(line_buffer_t *buf) {
-  for (size_t i = 0; i < buf->count; i++) {
-    free(buf->lines[i]);
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    size_t i = pool->next++;
+    pthread_mutex_unlock(&pool->lock);
+    if (i >= pool->count || jshell_is_interrupted()) break;
+    replace_file(rs, &pool->results[i]);
   }
-  free(buf->lines);
-  buf->lines = NULL;
-  buf->count = 0;
-  buf->capacity = 0;
+
+  if (rs.regex) jbox_regex_free(&regex);
+  return NULL;
 }
 
 
 /**
- * Adds a line to the end of a line buffer.
- * @param buf Pointer to line buffer
- * @param line Line to add (will be duplicated)
- * @return 0 on success, -1 on memory allocation failure
+ * Replaces in every file, on one worker per core when there are several.
+ * Files a worker could not take, because a thread or its regex could not
+ * be set up, are done on the calling thread afterwards.
+ * @param rs What to replace, with the regex compiled
+ * @param cflags Flags the regex was compiled with
+ * @param results One per file, with path set and status 2
+ * @param count Number of files
  */
-static int line_buffer_add(line_buffer_t *buf, const char *line) {
-  if (buf->count >= buf->capacity) {
-    size_t new_cap = buf->capacity == 0 ? 256 : buf->capacity * 2;
-    char **new_lines = realloc(buf->lines, new_cap * sizeof(char *));
-    if (!new_lines) return -1;
-    buf->lines = new_lines;
-    buf->capacity = new_cap;
+static void replace_files(const replace_spec_t *rs, int cflags,
+                          replace_result_t *results, size_t count) {
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t wanted = cores > 0 ? (size_t)cores : 1;
+  if (wanted > EDIT_REPLACE_MAX_WORKERS) wanted = EDIT_REPLACE_MAX_WORKERS;
+  if (wanted > count) wanted = count;
+
+  if (wanted > 1) {
+    replace_pool_t pool = {
+      .spec = rs, .cflags = cflags, .results = results, .count = count,
+    };
+    pthread_t threads[EDIT_REPLACE_MAX_WORKERS];
+    size_t started = 0;
+    pthread_mutex_init(&pool.lock, NULL);
+    while (started < wanted &&
+           pthread_create(&threads[started], NULL, replace_worker,
+                          &pool) == 0) {
+      started++;
+    }
+    for (size_t i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&pool.lock);
+  }
+
+  for (size_t i = 0; i < count && !jshell_is_interrupted(); i++) {
+    if (results[i].status == 2) replace_file(*rs, &results[i]);
   }
-  buf->lines[buf->count] = strdup(line);
-  if (!buf->lines[buf->count]) return -1;
-  buf->count++;
-  return 0;
 }
 
 
 /**
- * Reads all lines from a file into a line buffer.
- * @param path Path to file to read
- * @param buf Pointer to line buffer to populate
- * @return 0 on success, -1 on error, -2 if interrupted
+ * Reads file names from the current input stream, one per line.
+ * @param count Set to the number of names read
+ * @return Allocated array of allocated names, or NULL on error
  */
-static int read_file_lines(const char *path, line_buffer_t *buf) {
-  FILE *fp = fopen(path, "r");
-  if (!fp) return -1;
+static char **read_file_list(size_t *count) {
+  size_t cap = 64;
+  size_t n = 0;
+  char **names = malloc(cap * sizeof(char *));
+  if (!names) return NULL;
 
   char *line = NULL;
   size_t line_cap = 0;
-  ssize_t line_len;
-
-  while ((line_len = getline(&line, &line_cap, fp)) != -1) {
-    /* Check for interruption during file read */
-    if (jshell_is_interrupted()) {
-      free(line);
-      fclose(fp);
-      return -2;  /* Interrupted */
-    }
-
-    if (line_len > 0 && line[line_len - 1] == '\n') {
-      line[line_len - 1] = '\0';
-    }
-    if (line_buffer_add(buf, line) != 0) {
-      free(line);
-      fclose(fp);
-      return -1;
+  ssize_t len;
+  FILE *in = jshell_io_stdin();
+
+  while ((len = getline(&line, &line_cap, in)) != -1) {
+    if (len > 0 && line[len - 1] == '\n') line[--len] = '\0';
+    if (len == 0) continue;
+    if (n == cap) {
+      char **grown = realloc(names, cap * 2 * sizeof(char *));
+      if (!grown) break;
+      names = grown;
+      cap *= 2;
     }
+    if (!(names[n] = strdup(line))) break;
+    n++;
   }
 
   free(line);
-  fclose(fp);
-  return 0;
+  *count = n;
+  return names;
 }
 
 
 /**
- * Writes all lines from a buffer to a file.
- * @param path Path to file to write
- * @param buf Pointer to line buffer containing lines to write
- * @return 0 on success, -1 on error
+ * Prints the outcome of a run over several files as one JSON object.
+ * @param results One per file
+ * @param count Number of files
+ * @param status Overall status ("ok", "error" or "interrupted")
  */
-static int write_file_lines(const char *path, line_buffer_t *buf) {
-  FILE *fp = fopen(path, "w");
-  if (!fp) return -1;
+static void print_json_results(const replace_result_t *results, size_t count,
+                               const char *status) {
+  long long matches = 0, replacements = 0;
+  for (size_t i = 0; i < count; i++) {
+    matches += results[i].matches;
+    replacements += results[i].replacements;
+  }
 
-  for (size_t i = 0; i < buf->count; i++) {
-    if (fprintf(fp, "%s\n", buf->lines[i]) < 0) {
-      fclose(fp);
-      return -1;
+  jbox_json_writer_t w;
+  jbox_json_writer_init(&w, jshell_io_stdout(), false);
+  jbox_json_begin_object(&w);
+  jbox_json_key(&w, "status");
+  jbox_json_string(&w, status);
+  jbox_json_key(&w, "files");
+  jbox_json_int(&w, (long long)count);
+  jbox_json_key(&w, "matches");
+  jbox_json_int(&w, matches);
+  jbox_json_key(&w, "replacements");
+  jbox_json_int(&w, replacements);
+  jbox_json_key(&w, "results");
+  jbox_json_begin_array(&w);
+  for (size_t i = 0; i < count; i++) {
+    const replace_result_t *res = &results[i];
+    static const char *const statuses[] = {"error", "ok", "interrupted",
+                                           "skipped"};
+    jbox_json_begin_object(&w);
+    jbox_json_key(&w, "path");
+    jbox_json_string(&w, res->path);
+    jbox_json_key(&w, "status");
+    jbox_json_string(&w, statuses[res->status + 1]);
+    if (res->status == -1) {
+      jbox_json_key(&w, "message");
+      jbox_json_string(&w, strerror(res->err));
+    } else if (res->status != 2) {
+      jbox_json_key(&w, "matches");
+      jbox_json_int(&w, res->matches);
+      jbox_json_key(&w, "replacements");
+      jbox_json_int(&w, res->replacements);
     }
+    jbox_json_end_object(&w);
   }
-
-  fclose(fp);
-  return 0;
+  jbox_json_end_array(&w);
+  jbox_json_end_object(&w);
+  fputc('\n', jshell_io_stdout());
 }
 
 
@@ -419,13 +502,23 @@ static int edit_replace_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    edit_replace_print_usage(stdout);
+    edit_replace_print_usage(jshell_io_stdout());
     cleanup_edit_replace_argtable(&args);
     return 0;
   }
 
+  int many = args.files->count > 0;
   if (nerrors > 0) {
     arg_print_errors(stderr, args.end, "edit-replace");
+  } else if (!many && args.args->count < 3) {
+    fprintf(stderr, "edit-replace: missing FILE, PATTERN or REPLACEMENT\n");
+    nerrors = 1;
+  } else if (!many && args.args->count > 3) {
+    fprintf(stderr, "edit-replace: too many arguments; use --files to edit "
+            "several files\n");
+    nerrors = 1;
+  }
+  if (nerrors > 0) {
     fprintf(stderr, "Try 'edit-replace --help' for more information.\n");
     cleanup_edit_replace_argtable(&args);
     return 1;
@@ -434,24 +527,42 @@ static int edit_replace_run(int argc, char **argv) {
   int show_json = args.json->count > 0;
   int case_insensitive = args.case_insensitive->count > 0;
   int fixed_strings = args.fixed_strings->count > 0;
-  const char *filepath = args.file->filename[0];
-  const char *pattern = args.pattern->sval[0];
-  const char *replacement = args.replacement->sval[0];
+  const char **words = args.args->sval;
+  const char *filepath = many ? NULL : words[0];
+  const char *pattern = words[many ? 0 : 1];
+  const char *replacement = words[many ? 1 : 2];
+  const char *label = filepath ? filepath : "";
+  int count_only = args.count_only->count > 0;
+  long max_replacements = -1;
+
+  if (args.max_replacements->count > 0) {
+    max_replacements = args.max_replacements->ival[0];
+    if (max_replacements < 1) {
+      if (show_json) {
+        print_json_result(label, "error", 0, 0,
+                          "max replacements must be >= 1");
+      } else {
+        fprintf(stderr, "edit-replace: max replacements must be >= 1\n");
+      }
+      cleanup_edit_replace_argtable(&args);
+      return 1;
+    }
+  }
 
   // Compile regex if not using fixed strings
-  regex_t regex;
+  jbox_regex_t regex;
   int regex_compiled = 0;
+  int cflags = REG_EXTENDED;
+  if (case_insensitive) {
+    cflags |= REG_ICASE;
+  }
   if (!fixed_strings) {
-    int cflags = REG_EXTENDED;
-    if (case_insensitive) {
-      cflags |= REG_ICASE;
-    }
-    int ret = regcomp(&regex, pattern, cflags);
+    int ret = jbox_regex_compile(&regex, pattern, cflags);
     if (ret != 0) {
       char errbuf[256];
-      regerror(ret, &regex, errbuf, sizeof(errbuf));
+      jbox_regex_error(ret, &regex, errbuf, sizeof(errbuf));
       if (show_json) {
-        print_json_result(filepath, "error", 0, 0, errbuf);
+        print_json_result(label, "error", 0, 0, errbuf);
       } else {
         fprintf(stderr, "edit-replace: invalid regex: %s\n", errbuf);
       }
@@ -461,107 +572,95 @@ static int edit_replace_run(int argc, char **argv) {
     regex_compiled = 1;
   }
 
-  line_buffer_t lines;
-  line_buffer_init(&lines);
-
-  int read_result = read_file_lines(filepath, &lines);
-  if (read_result == -2) {
-    /* Interrupted by signal */
-    if (show_json) {
-      print_json_result(filepath, "interrupted", 0, 0, "operation interrupted");
-    } else {
-      fprintf(stderr, "edit-replace: interrupted\n");
-    }
-    line_buffer_free(&lines);
-    if (regex_compiled) regfree(&regex);
-    cleanup_edit_replace_argtable(&args);
-    return 130;  /* 128 + SIGINT(2) */
-  } else if (read_result != 0) {
-    if (show_json) {
-      print_json_result(filepath, "error", 0, 0, strerror(errno));
-    } else {
-      fprintf(stderr, "edit-replace: %s: %s\n", filepath, strerror(errno));
-    }
-    line_buffer_free(&lines);
-    if (regex_compiled) regfree(&regex);
+  replace_spec_t rs = {
+    .regex = regex_compiled ? &regex : NULL,
+    .pattern = pattern,
+    .pattern_len = strlen(pattern),
+    .replacement = replacement,
+    .replacement_len = strlen(replacement),
+    .case_insensitive = case_insensitive,
+    .count_only = count_only,
+    .left = max_replacements,
+  };
+
+  /* The files: one, those after the replacement, or a list on stdin */
+  char **listed = NULL;
+  size_t count = many ? (size_t)args.args->count - 2 : 1;
+  if (many && count == 0) {
+    listed = read_file_list(&count);
+  }
+  replace_result_t *results = calloc(count ? count : 1, sizeof(*results));
+  if (!results || (many && count == 0 && !listed)) {
+    fprintf(stderr, "edit-replace: memory allocation failed\n");
+    free(results);
+    free(listed);
+    if (regex_compiled) jbox_regex_free(&regex);
     cleanup_edit_replace_argtable(&args);
     return 1;
   }
+  for (size_t i = 0; i < count; i++) {
+    results[i].path = listed ? listed[i] : many ? words[i + 2] : filepath;
+    results[i].status = 2;
+  }
 
-  int total_matches = 0;
-  int total_replacements = 0;
+  replace_files(&rs, cflags, results, count);
 
-  for (size_t i = 0; i < lines.count; i++) {
-    /* Check for interruption during replacement */
-    if (jshell_is_interrupted()) {
+  if (regex_compiled) {
+    jbox_regex_free(&regex);
+  }
+
+  int failed = 0, interrupted = jshell_is_interrupted();
+  for (size_t i = 0; i < count; i++) {
+    if (results[i].status == -1) failed = 1;
+    if (results[i].status == 1) interrupted = 1;
+  }
+
+  if (!many) {
+    replace_result_t *res = &results[0];
+    if (res->status == 1) {
       if (show_json) {
-        print_json_result(filepath, "interrupted", total_matches,
-                          total_replacements, "operation interrupted");
+        print_json_result(filepath, "interrupted", res->matches,
+                          res->replacements, "operation interrupted");
       } else {
         fprintf(stderr, "edit-replace: interrupted\n");
       }
-      line_buffer_free(&lines);
-      if (regex_compiled) regfree(&regex);
-      cleanup_edit_replace_argtable(&args);
-      return 130;  /* 128 + SIGINT(2) */
-    }
-    int count = 0;
-    char *new_line;
-
-    if (fixed_strings) {
-      new_line = str_replace_literal(lines.lines[i], pattern, replacement,
-                                      case_insensitive, &count);
-    } else {
-      new_line = str_replace_regex(lines.lines[i], &regex, replacement, &count);
-    }
-
-    if (!new_line) {
+    } else if (res->status == -1) {
       if (show_json) {
-        print_json_result(filepath, "error", 0, 0, "memory allocation failed");
+        print_json_result(filepath, "error", 0, 0, strerror(res->err));
       } else {
-        fprintf(stderr, "edit-replace: memory allocation failed\n");
+        fprintf(stderr, "edit-replace: %s: %s\n", filepath,
+                strerror(res->err));
       }
-      line_buffer_free(&lines);
-      if (regex_compiled) regfree(&regex);
-      cleanup_edit_replace_argtable(&args);
-      return 1;
+    } else if (show_json) {
+      print_json_result(filepath, "ok", res->matches, res->replacements,
+                        NULL);
+    } else if (count_only) {
+      fprintf(jshell_io_stdout(), "%d\n", res->matches);
     }
-
-    if (count > 0) {
-      total_matches += count;
-      total_replacements += count;
-      free(lines.lines[i]);
-      lines.lines[i] = new_line;
-    } else {
-      free(new_line);
-    }
-  }
-
-  if (regex_compiled) {
-    regfree(&regex);
-  }
-
-  if (total_replacements > 0) {
-    if (write_file_lines(filepath, &lines) != 0) {
-      if (show_json) {
-        print_json_result(filepath, "error", 0, 0, strerror(errno));
-      } else {
-        fprintf(stderr, "edit-replace: failed to write %s: %s\n",
-                filepath, strerror(errno));
+  } else if (show_json) {
+    print_json_results(results, count, interrupted ? "interrupted"
+                                       : failed ? "error" : "ok");
+  } else {
+    for (size_t i = 0; i < count; i++) {
+      if (results[i].status == -1) {
+        fprintf(stderr, "edit-replace: %s: %s\n", results[i].path,
+                strerror(results[i].err));
+      } else if (count_only && results[i].status == 0) {
+        fprintf(jshell_io_stdout(), "%s:%d\n", results[i].path,
+                results[i].matches);
       }
-      line_buffer_free(&lines);
-      cleanup_edit_replace_argtable(&args);
-      return 1;
     }
+    if (interrupted) fprintf(stderr, "edit-replace: interrupted\n");
   }
 
-  if (show_json) {
-    print_json_result(filepath, "ok", total_matches, total_replacements, NULL);
+  if (listed) {
+    for (size_t i = 0; i < count; i++) free(listed[i]);
+    free(listed);
   }
-
-  line_buffer_free(&lines);
+  free(results);
   cleanup_edit_replace_argtable(&args);
-  return 0;
+  if (interrupted) return 130;  /* 128 + SIGINT(2) */
+  return failed ? 1 : 0;
 }
 
 
@@ -571,11 +670,17 @@ static int edit_replace_run(int argc, char **argv) {
 const jshell_cmd_spec_t cmd_edit_replace_spec = {
   .name = "edit-replace",
   .summary = "global find/replace with regex in a file",
-  .long_help = "Replace all occurrences of PATTERN with REPLACEMENT in FILE. "
-               "PATTERN is a regex by default; use --fixed-strings for literal.",
+  .long_help = "Replace all occurrences of PATTERN with REPLACEMENT in FILE, "
+               "or with --files in each FILE listed (or named on stdin), "
+               "editing files in parallel. "
+               "PATTERN is a regex by default; use --fixed-strings for "
+               "literal. "
+               "--count-only reports the number of matches without editing, "
+               "and --max-replacements stops after N.",
   .type = CMD_BUILTIN,
   .run = edit_replace_run,
-  .print_usage = edit_replace_print_usage
+  .print_usage = edit_replace_print_usage,
+  .describe_args = edit_replace_describe_args
 };
 
 
@@ -10,6 +10,9 @@
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "jshell/jshell_io.h"
+#include "utils/jbox_json.h"
+#include "utils/jbox_line_edit.h"
 
 
 /**
@@ -75,36 +78,18 @@ static void edit_replace_line_print_usage(FILE *out) {
 
 
 /**
- * Escapes special characters in a string for JSON output.
- * @param str Input string to escape
- * @param out Output buffer for escaped string
- * @param out_size Size of output buffer
+ * Passes the edit-replace-line argtable to visit, for tool schemas derived
+ * from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
  */
-static void escape_json_string(const char *str, char *out, size_t out_size) {
-  size_t j = 0;
-  for (size_t i = 0; str[i] && j < out_size - 1; i++) {
-    char c = str[i];
-    if (c == '"' || c == '\\') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = c;
-    } else if (c == '\n') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = 'n';
-    } else if (c == '\r') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = 'r';
-    } else if (c == '\t') {
-      if (j + 2 >= out_size) break;
-      out[j++] = '\\';
-      out[j++] = 't';
-    } else {
-      out[j++] = c;
-    }
-  }
-  out[j] = '\0';
+static void edit_replace_line_describe_args(jshell_argtable_visit_fn visit,
+                                            void *userdata) {
+  edit_replace_line_args_t args;
+  build_edit_replace_line_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_edit_replace_line_argtable(&args);
 }
 
 
@@ -117,129 +102,15 @@ static void escape_json_string(const char *str, char *out, size_t out_size) {
  */
 static void print_json_result(const char *path, int line, const char *status,
                               const char *message) {
-  char escaped_path[512];
-  escape_json_string(path, escaped_path, sizeof(escaped_path));
-
+  FILE *out = jshell_io_stdout();
+  fputs("{\"path\": ", out);
+  jbox_json_write_string(out, path);
+  fprintf(out, ", \"line\": %d, \"status\": \"%s\"", line, status);
   if (message) {
-    char escaped_msg[512];
-    escape_json_string(message, escaped_msg, sizeof(escaped_msg));
-    printf("{\"path\": \"%s\", \"line\": %d, \"status\": \"%s\", "
-           "\"message\": \"%s\"}\n",
-           escaped_path, line, status, escaped_msg);
-  } else {
-    printf("{\"path\": \"%s\", \"line\": %d, \"status\": \"%s\"}\n",
-           escaped_path, line, status);
-  }
-}
-
-
-/**
- * Dynamic buffer for storing lines of text from a file
- */
-typedef struct {
-  char **lines;
-  size_t count;
-  size_t capacity;
-} line_buffer_t;
-
-
-/**
- * Initializes a line buffer to empty state.
- * @param buf Pointer to line buffer to initialize
- */
-static void line_buffer_init(line_buffer_t *buf) {
-  buf->lines = NULL;
-  buf->count = 0;
-  buf->capacity = 0;
-}
-
-
-/**
- * Frees all memory associated with a line buffer.
- * @param buf Pointer to line buffer to free
- */
-static void line_buffer_free(line_buffer_t *buf) {
-  for (size_t i = 0; i < buf->count; i++) {
-    free(buf->lines[i]);
-  }
-  free(buf->lines);
-  buf->lines = NULL;
-  buf->count = 0;
-  buf->capacity = 0;
-}
-
-
-/**
- * Adds a line to the end of a line buffer.
- * @param buf Pointer to line buffer
- * @param line Line to add (will be duplicated)
- * @return 0 on success, -1 on memory allocation failure
- */
-static int line_buffer_add(line_buffer_t *buf, const char *line) {
-  if (buf->count >= buf->capacity) {
-    size_t new_cap = buf->capacity == 0 ? 256 : buf->capacity * 2;
-    char **new_lines = realloc(buf->lines, new_cap * sizeof(char *));
-    if (!new_lines) return -1;
-    buf->lines = new_lines;
-    buf->capacity = new_cap;
+    fputs(", \"message\": ", out);
+    jbox_json_write_string(out, message);
   }
-  buf->lines[buf->count] = strdup(line);
-  if (!buf->lines[buf->count]) return -1;
-  buf->count++;
-  return 0;
-}
-
-
-/**
- * Reads all lines from a file into a line buffer.
- * @param path Path to file to read
- * @param buf Pointer to line buffer to populate
- * @return 0 on success, -1 on error
- */
-static int read_file_lines(const char *path, line_buffer_t *buf) {
-  FILE *fp = fopen(path, "r");
-  if (!fp) return -1;
-
-  char *line = NULL;
-  size_t line_cap = 0;
-  ssize_t line_len;
-
-  while ((line_len = getline(&line, &line_cap, fp)) != -1) {
-    if (line_len > 0 && line[line_len - 1] == '\n') {
-      line[line_len - 1] = '\0';
-    }
-    if (line_buffer_add(buf, line) != 0) {
-      free(line);
-      fclose(fp);
-      return -1;
-    }
-  }
-
-  free(line);
-  fclose(fp);
-  return 0;
-}
-
-
-/**
- * Writes all lines from a buffer to a file.
- * @param path Path to file to write
- * @param buf Pointer to line buffer containing lines to write
- * @return 0 on success, -1 on error
- */
-static int write_file_lines(const char *path, line_buffer_t *buf) {
-  FILE *fp = fopen(path, "w");
-  if (!fp) return -1;
-
-  for (size_t i = 0; i < buf->count; i++) {
-    if (fprintf(fp, "%s\n", buf->lines[i]) < 0) {
-      fclose(fp);
-      return -1;
-    }
-  }
-
-  fclose(fp);
-  return 0;
+  fputs("}\n", out);
 }
 
 
@@ -256,7 +127,7 @@ static int edit_replace_line_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    edit_replace_line_print_usage(stdout);
+    edit_replace_line_print_usage(jshell_io_stdout());
     cleanup_edit_replace_line_argtable(&args);
     return 0;
   }
@@ -284,54 +155,26 @@ static int edit_replace_line_run(int argc, char **argv) {
     return 1;
   }
 
-  line_buffer_t lines;
-  line_buffer_init(&lines);
-
-  if (read_file_lines(filepath, &lines) != 0) {
-    if (show_json) {
-      print_json_result(filepath, line_num, "error", strerror(errno));
-    } else {
-      fprintf(stderr, "edit-replace-line: %s: %s\n", filepath, strerror(errno));
-    }
-    line_buffer_free(&lines);
-    cleanup_edit_replace_line_argtable(&args);
-    return 1;
-  }
-
-  if ((size_t)line_num > lines.count) {
+  size_t count = 0;
+  int rc = jbox_line_edit_at(filepath, JBOX_LINE_REPLACE, (size_t)line_num,
+                             text, &count);
+  if (rc == 1) {
     if (show_json) {
       print_json_result(filepath, line_num, "error",
                         "line number exceeds file length");
     } else {
       fprintf(stderr, "edit-replace-line: line %d exceeds file length (%zu)\n",
-              line_num, lines.count);
+              line_num, count);
     }
-    line_buffer_free(&lines);
     cleanup_edit_replace_line_argtable(&args);
     return 1;
   }
-
-  free(lines.lines[line_num - 1]);
-  lines.lines[line_num - 1] = strdup(text);
-  if (!lines.lines[line_num - 1]) {
-    if (show_json) {
-      print_json_result(filepath, line_num, "error", "memory allocation failed");
-    } else {
-      fprintf(stderr, "edit-replace-line: memory allocation failed\n");
-    }
-    line_buffer_free(&lines);
-    cleanup_edit_replace_line_argtable(&args);
-    return 1;
-  }
-
-  if (write_file_lines(filepath, &lines) != 0) {
+  if (rc != 0) {
     if (show_json) {
       print_json_result(filepath, line_num, "error", strerror(errno));
     } else {
-      fprintf(stderr, "edit-replace-line: failed to write %s: %s\n",
-              filepath, strerror(errno));
+      fprintf(stderr, "edit-replace-line: %s: %s\n", filepath, strerror(errno));
     }
-    line_buffer_free(&lines);
     cleanup_edit_replace_line_argtable(&args);
     return 1;
   }
@@ -340,7 +183,6 @@ static int edit_replace_line_run(int argc, char **argv) {
     print_json_result(filepath, line_num, "ok", NULL);
   }
 
-  line_buffer_free(&lines);
   cleanup_edit_replace_line_argtable(&args);
   return 0;
 }
@@ -356,7 +198,8 @@ const jshell_cmd_spec_t cmd_edit_replace_line_spec = {
                "Line numbers are 1-based.",
   .type = CMD_BUILTIN,
   .run = edit_replace_line_run,
-  .print_usage = edit_replace_line_print_usage
+  .print_usage = edit_replace_line_print_usage,
+  .describe_args = edit_replace_line_describe_args
 };
 
 
@@ -9,6 +9,7 @@
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "jshell/jshell_io.h"
 
 extern char **environ;
 
@@ -68,6 +69,20 @@ static void env_print_usage(FILE *out) {
 }
 
 
+/**
+ * Passes the env argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void env_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  env_args_t args;
+  build_env_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_env_argtable(&args);
+}
+
+
 /**
  * Escapes special characters in a string for JSON output.
  *
@@ -117,7 +132,7 @@ static int env_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    env_print_usage(stdout);
+    env_print_usage(jshell_io_stdout());
     cleanup_env_argtable(&args);
     return 0;
   }
@@ -132,7 +147,7 @@ static int env_run(int argc, char **argv) {
   int show_json = args.json->count > 0;
 
   if (show_json) {
-    printf("{\"env\": {\n");
+    jshell_printf("{\"env\": {\n");
     int first = 1;
     for (char **e = environ; *e != NULL; e++) {
       char *eq = strchr(*e, '=');
@@ -151,15 +166,15 @@ static int env_run(int argc, char **argv) {
       escape_json_string(value, escaped_value, sizeof(escaped_value));
 
       if (!first) {
-        printf(",\n");
+        jshell_printf(",\n");
       }
       first = 0;
-      printf("  \"%s\": \"%s\"", escaped_key, escaped_value);
+      jshell_printf("  \"%s\": \"%s\"", escaped_key, escaped_value);
     }
-    printf("\n}}\n");
+    jshell_printf("\n}}\n");
   } else {
     for (char **e = environ; *e != NULL; e++) {
-      printf("%s\n", *e);
+      jshell_printf("%s\n", *e);
     }
   }
 
@@ -177,7 +192,8 @@ const jshell_cmd_spec_t cmd_env_spec = {
   .long_help = "Print the current environment variables.",
   .type = CMD_BUILTIN,
   .run = env_run,
-  .print_usage = env_print_usage
+  .print_usage = env_print_usage,
+  .describe_args = env_describe_args
 };
 
 
@@ -10,6 +10,8 @@
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "jshell/jshell_io.h"
+#include "jshell/jshell_vars.h"
 
 
 /**
@@ -32,8 +34,8 @@ typedef struct {
 static void build_export_argtable(export_args_t *args) {
   args->help = arg_lit0("h", "help", "display this help and exit");
   args->json = arg_lit0(NULL, "json", "output in JSON format");
-  args->vars = arg_strn(NULL, NULL, "KEY=VALUE", 0, 100,
-                        "environment variables to set");
+  args->vars = arg_strn(NULL, NULL, "KEY[=VALUE]", 0, 100,
+                        "environment variables to set or export");
   args->end  = arg_end(20);
 
   args->argtable[0] = args->help;
@@ -65,14 +67,31 @@ static void export_print_usage(FILE *out) {
   fprintf(out, "Usage: export");
   arg_print_syntax(out, args.argtable, "\n");
   fprintf(out, "Set environment variables.\n\n");
-  fprintf(out, "Each argument should be in the form KEY=VALUE.\n");
-  fprintf(out, "The variable is set in the current shell environment.\n\n");
+  fprintf(out, "Each argument should be in the form KEY=VALUE, or KEY to "
+               "export an\n");
+  fprintf(out, "existing shell variable. Exported variables are passed to "
+               "commands.\n\n");
   fprintf(out, "Options:\n");
   arg_print_glossary(out, args.argtable, "  %-20s %s\n");
   cleanup_export_argtable(&args);
 }
 
 
+/**
+ * Passes the export argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void export_describe_args(jshell_argtable_visit_fn visit,
+                                 void *userdata) {
+  export_args_t args;
+  build_export_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_export_argtable(&args);
+}
+
+
 /**
  * Escapes special characters in a string for JSON output.
  *
@@ -122,7 +141,7 @@ static int export_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    export_print_usage(stdout);
+    export_print_usage(jshell_io_stdout());
     cleanup_export_argtable(&args);
     return 0;
   }
@@ -139,21 +158,33 @@ static int export_run(int argc, char **argv) {
   int first = 1;
 
   if (show_json) {
-    printf("[\n");
+    jshell_printf("[\n");
   }
 
   for (int i = 0; i < args.vars->count; i++) {
     const char *var = args.vars->sval[i];
     char *eq = strchr(var, '=');
 
+    if (eq == NULL && jshell_var_export(var) == 0) {
+      if (show_json) {
+        char escaped_var[512];
+        escape_json_string(var, escaped_var, sizeof(escaped_var));
+        if (!first) jshell_printf(",\n");
+        first = 0;
+        jshell_printf("{\"key\": \"%s\", \"status\": \"ok\"}",
+                      escaped_var);
+      }
+      continue;
+    }
+
     if (eq == NULL) {
       if (show_json) {
         char escaped_var[512];
         escape_json_string(var, escaped_var, sizeof(escaped_var));
-        if (!first) printf(",\n");
+        if (!first) jshell_printf(",\n");
         first = 0;
-        printf("{\"key\": \"%s\", \"status\": \"error\", \"message\": "
-               "\"missing '=' in variable assignment\"}", escaped_var);
+        jshell_printf("{\"key\": \"%s\", \"status\": \"error\", \"message\": "
+                      "\"missing '=' in variable assignment\"}", escaped_var);
       } else {
         fprintf(stderr, "export: '%s': not a valid identifier\n", var);
       }
@@ -168,16 +199,17 @@ static int export_run(int argc, char **argv) {
 
     char *value = eq + 1;
 
-    if (setenv(key, value, 1) != 0) {
+    if (jshell_var_set(key, value, JSHELL_VAR_EXPORT) != 0) {
       if (show_json) {
         char escaped_key[256];
         char escaped_msg[256];
         escape_json_string(key, escaped_key, sizeof(escaped_key));
         escape_json_string(strerror(errno), escaped_msg, sizeof(escaped_msg));
-        if (!first) printf(",\n");
+        if (!first) jshell_printf(",\n");
         first = 0;
-        printf("{\"key\": \"%s\", \"status\": \"error\", \"message\": \"%s\"}",
-               escaped_key, escaped_msg);
+        jshell_printf("{\"key\": \"%s\", \"status\": \"error\", "
+                      "\"message\": \"%s\"}",
+                      escaped_key, escaped_msg);
       } else {
         fprintf(stderr, "export: cannot set '%s': %s\n", key, strerror(errno));
       }
@@ -188,16 +220,17 @@ static int export_run(int argc, char **argv) {
         char escaped_value[4096];
         escape_json_string(key, escaped_key, sizeof(escaped_key));
         escape_json_string(value, escaped_value, sizeof(escaped_value));
-        if (!first) printf(",\n");
+        if (!first) jshell_printf(",\n");
         first = 0;
-        printf("{\"key\": \"%s\", \"value\": \"%s\", \"status\": \"ok\"}",
-               escaped_key, escaped_value);
+        jshell_printf("{\"key\": \"%s\", \"value\": \"%s\", "
+                      "\"status\": \"ok\"}",
+                      escaped_key, escaped_value);
       }
     }
   }
 
   if (show_json) {
-    printf("\n]\n");
+    jshell_printf("\n]\n");
   }
 
   cleanup_export_argtable(&args);
@@ -212,10 +245,12 @@ const jshell_cmd_spec_t cmd_export_spec = {
   .name = "export",
   .summary = "set environment variables",
   .long_help = "Set environment variables in the current shell. "
-               "Each argument should be in the form KEY=VALUE.",
+               "Each argument should be in the form KEY=VALUE, or KEY "
+               "to export an existing shell variable.",
   .type = CMD_BUILTIN,
   .run = export_run,
-  .print_usage = export_print_usage
+  .print_usage = export_print_usage,
+  .describe_args = export_describe_args
 };
 
 
@@ -0,0 +1,250 @@
+/**
+ * @file cmd_hash.c
+ * @brief Remember or display resolved command locations builtin
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "argtable3.h"
+#include "jshell/jshell_cmd_registry.h"
+#include "jshell/jshell_io.h"
+#include "jshell/jshell_path.h"
+
+
+/**
+ * Arguments structure for the hash command.
+ */
+typedef struct {
+  struct arg_lit *help;
+  struct arg_lit *reset;
+  struct arg_lit *json;
+  struct arg_str *names;
+  struct arg_end *end;
+  void *argtable[5];
+} hash_args_t;
+
+
+/**
+ * Builds the argtable3 structure for the hash command.
+ *
+ * @param args Pointer to hash_args_t structure to populate
+ */
+static void build_hash_argtable(hash_args_t *args) {
+  args->help  = arg_lit0("h", "help", "display this help and exit");
+  args->reset = arg_lit0("r", NULL, "forget all remembered locations");
+  args->json  = arg_lit0(NULL, "json", "output in JSON format");
+  args->names = arg_strn(NULL, NULL, "NAME", 0, 100,
+                         "command names to look up and remember");
+  args->end   = arg_end(20);
+
+  args->argtable[0] = args->help;
+  args->argtable[1] = args->reset;
+  args->argtable[2] = args->json;
+  args->argtable[3] = args->names;
+  args->argtable[4] = args->end;
+}
+
+
+/**
+ * Frees memory allocated for the hash argtable.
+ *
+ * @param args Pointer to hash_args_t structure to cleanup
+ */
+static void cleanup_hash_argtable(hash_args_t *args) {
+  arg_freetable(args->argtable,
+                sizeof(args->argtable) / sizeof(args->argtable[0]));
+}
+
+
+/**
+ * Prints usage information for the hash command.
+ *
+ * @param out Output stream to write usage information to
+ */
+static void hash_print_usage(FILE *out) {
+  hash_args_t args;
+  build_hash_argtable(&args);
+  fprintf(out, "Usage: hash");
+  arg_print_syntax(out, args.argtable, "\n");
+  fprintf(out, "Remember or display command locations.\n\n");
+  fprintf(out, "With no NAME, list the remembered commands and how often\n");
+  fprintf(out, "each was used. With NAME, resolve it through PATH and\n");
+  fprintf(out, "remember the result. Entries are forgotten automatically\n");
+  fprintf(out, "when PATH or a searched directory changes.\n\n");
+  fprintf(out, "Options:\n");
+  arg_print_glossary(out, args.argtable, "  %-20s %s\n");
+  cleanup_hash_argtable(&args);
+}
+
+
+/**
+ * Passes the hash argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void hash_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  hash_args_t args;
+  build_hash_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_hash_argtable(&args);
+}
+
+
+/**
+ * Escapes special characters in a string for JSON output.
+ *
+ * @param str Input string to escape
+ * @param out Output buffer for escaped string
+ * @param out_size Size of output buffer
+ */
+static void escape_json_string(const char *str, char *out, size_t out_size) {
+  size_t j = 0;
+  for (size_t i = 0; str[i] && j < out_size - 1; i++) {
+    char c = str[i];
+    if (c == '"' || c == '\\') {
+      if (j + 2 >= out_size) break;
+      out[j++] = '\\';
+      out[j++] = c;
+    } else if (c == '\n') {
+      if (j + 2 >= out_size) break;
+      out[j++] = '\\';
+      out[j++] = 'n';
+    } else if (c == '\r') {
+      if (j + 2 >= out_size) break;
+      out[j++] = '\\';
+      out[j++] = 'r';
+    } else if (c == '\t') {
+      if (j + 2 >= out_size) break;
+      out[j++] = '\\';
+      out[j++] = 't';
+    } else {
+      out[j++] = c;
+    }
+  }
+  out[j] = '\0';
+}
+
+
+/** State shared with the listing callback */
+typedef struct {
+  int show_json;
+  int first;
+} hash_list_ctx_t;
+
+
+/**
+ * Prints one remembered command location.
+ *
+ * @param name Command name
+ * @param path Resolved executable path
+ * @param hits Number of times the entry was used
+ * @param userdata Pointer to hash_list_ctx_t
+ */
+static void print_hash_entry(const char *name, const char *path,
+                             unsigned long hits, void *userdata) {
+  hash_list_ctx_t *ctx = userdata;
+
+  if (ctx->show_json) {
+    char escaped_name[256];
+    char escaped_path[PATH_MAX * 2];
+    escape_json_string(name, escaped_name, sizeof(escaped_name));
+    escape_json_string(path, escaped_path, sizeof(escaped_path));
+    if (!ctx->first) jshell_printf(",\n");
+    jshell_printf("{\"name\": \"%s\", \"path\": \"%s\", \"hits\": %lu}",
+                  escaped_name, escaped_path, hits);
+  } else {
+    if (ctx->first) jshell_printf("hits\tcommand\n");
+    jshell_printf("%4lu\t%s\n", hits, path);
+  }
+  ctx->first = 0;
+}
+
+
+/**
+ * Executes the hash command.
+ *
+ * @param argc Number of arguments
+ * @param argv Array of argument strings
+ * @return 0 on success, 1 on failure
+ */
+static int hash_run(int argc, char **argv) {
+  hash_args_t args;
+  build_hash_argtable(&args);
+
+  int nerrors = arg_parse(argc, argv, args.argtable);
+
+  if (args.help->count > 0) {
+    hash_print_usage(jshell_io_stdout());
+    cleanup_hash_argtable(&args);
+    return 0;
+  }
+
+  if (nerrors > 0) {
+    arg_print_errors(stderr, args.end, "hash");
+    fprintf(stderr, "Try 'hash --help' for more information.\n");
+    cleanup_hash_argtable(&args);
+    return 1;
+  }
+
+  int show_json = args.json->count > 0;
+  int result = 0;
+
+  if (args.reset->count > 0) {
+    jshell_path_cache_clear();
+  }
+
+  for (int i = 0; i < args.names->count; i++) {
+    const char *name = args.names->sval[i];
+    char *path = jshell_resolve_command(name);
+    if (path == NULL) {
+      fprintf(stderr, "hash: %s: not found\n", name);
+      result = 1;
+      continue;
+    }
+    free(path);
+  }
+
+  if (args.names->count == 0 && args.reset->count == 0) {
+    hash_list_ctx_t ctx = { .show_json = show_json, .first = 1 };
+
+    if (show_json) {
+      jshell_printf("[\n");
+    }
+    jshell_path_cache_for_each(print_hash_entry, &ctx);
+    if (show_json) {
+      jshell_printf("\n]\n");
+    } else if (ctx.first) {
+      jshell_printf("hash: hash table empty\n");
+    }
+  }
+
+  cleanup_hash_argtable(&args);
+  return result;
+}
+
+
+/**
+ * Command specification for the hash builtin.
+ */
+const jshell_cmd_spec_t cmd_hash_spec = {
+  .name = "hash",
+  .summary = "remember or display command locations",
+  .long_help = "Display the table of remembered command locations, add "
+               "NAMEs to it, or clear it with -r.",
+  .type = CMD_BUILTIN,
+  .run = hash_run,
+  .print_usage = hash_print_usage,
+  .describe_args = hash_describe_args
+};
+
+
+/**
+ * Registers the hash command with the shell command registry.
+ */
+void jshell_register_hash_command(void) {
+  jshell_register_command(&cmd_hash_spec);
+}
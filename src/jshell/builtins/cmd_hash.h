@@ -0,0 +1,12 @@
+#ifndef CMD_HASH_H
+#define CMD_HASH_H
+
+#include "jshell/jshell_cmd_registry.h"
+
+
+extern const jshell_cmd_spec_t cmd_hash_spec;
+
+void jshell_register_hash_command(void);
+
+
+#endif
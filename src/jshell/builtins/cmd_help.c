@@ -9,6 +9,7 @@
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "jshell/jshell_io.h"
 
 
 /**
@@ -70,6 +71,20 @@ static void help_print_usage(FILE *out) {
 }
 
 
+/**
+ * Passes the help argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void help_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  help_args_t args;
+  build_help_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_help_argtable(&args);
+}
+
+
 /**
  * Callback function to print a command summary.
  *
@@ -80,7 +95,7 @@ static void print_command_summary(const jshell_cmd_spec_t *spec,
                                   void *userdata) {
   (void)userdata;
   const char *type_str = (spec->type == CMD_BUILTIN) ? "builtin" : "external";
-  printf("  %-20s %s (%s)\n", spec->name, spec->summary, type_str);
+  jshell_printf("  %-20s %s (%s)\n", spec->name, spec->summary, type_str);
 }
 
 
@@ -98,7 +113,7 @@ static int help_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    help_print_usage(stdout);
+    help_print_usage(jshell_io_stdout());
     cleanup_help_argtable(&args);
     return 0;
   }
@@ -121,18 +136,18 @@ static int help_run(int argc, char **argv) {
     }
 
     if (spec->print_usage != NULL) {
-      spec->print_usage(stdout);
+      spec->print_usage(jshell_io_stdout());
     } else {
-      printf("%s - %s\n", spec->name, spec->summary);
+      jshell_printf("%s - %s\n", spec->name, spec->summary);
       if (spec->long_help != NULL) {
-        printf("\n%s\n", spec->long_help);
+        jshell_printf("\n%s\n", spec->long_help);
       }
     }
   } else {
-    printf("Available commands:\n\n");
+    jshell_printf("Available commands:\n\n");
     jshell_for_each_command(print_command_summary, NULL);
-    printf("\nType 'help COMMAND' for more information on a specific "
-           "command.\n");
+    jshell_printf("\nType 'help COMMAND' for more information on a specific "
+                  "command.\n");
   }
 
   cleanup_help_argtable(&args);
@@ -150,7 +165,8 @@ const jshell_cmd_spec_t cmd_help_spec = {
                "for a specific command if provided as an argument.",
   .type = CMD_BUILTIN,
   .run = help_run,
-  .print_usage = help_print_usage
+  .print_usage = help_print_usage,
+  .describe_args = help_describe_args
 };
 
 
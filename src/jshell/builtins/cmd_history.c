@@ -5,9 +5,11 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "jshell/jshell_io.h"
 #include "jshell/jshell_history.h"
 
 
@@ -16,8 +18,11 @@
  */
 typedef struct {
   struct arg_lit *help;
+  struct arg_str *search;
+  struct arg_str *prefix;
+  struct arg_lit *json;
   struct arg_end *end;
-  void *argtable[2];
+  void *argtable[5];
 } history_args_t;
 
 
@@ -28,10 +33,18 @@ typedef struct {
  */
 static void build_history_argtable(history_args_t *args) {
   args->help = arg_lit0("h", "help", "display this help and exit");
+  args->search = arg_str0("s", "search", "TEXT",
+                          "only show commands containing TEXT");
+  args->prefix = arg_str0("p", "prefix", "TEXT",
+                          "only show commands starting with TEXT");
+  args->json = arg_lit0(NULL, "json", "output in JSON format");
   args->end = arg_end(20);
 
   args->argtable[0] = args->help;
-  args->argtable[1] = args->end;
+  args->argtable[1] = args->search;
+  args->argtable[2] = args->prefix;
+  args->argtable[3] = args->json;
+  args->argtable[4] = args->end;
 }
 
 
@@ -57,14 +70,118 @@ static void history_print_usage(FILE *out) {
   fprintf(out, "Usage: history");
   arg_print_syntax(out, args.argtable, "\n");
   fprintf(out, "Display command history.\n\n");
-  fprintf(out, "Shows a numbered list of commands that have been entered\n");
-  fprintf(out, "in the current shell session.\n\n");
+  fprintf(out, "Shows a numbered list of commands entered in jshell.\n");
+  fprintf(out, "History is kept in ~/.jshell/history and shared between\n");
+  fprintf(out, "sessions. JSON output includes each command's start time,\n");
+  fprintf(out, "exit status and duration.\n\n");
   fprintf(out, "Options:\n");
   arg_print_glossary(out, args.argtable, "  %-20s %s\n");
   cleanup_history_argtable(&args);
 }
 
 
+/**
+ * Passes the history argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void history_describe_args(jshell_argtable_visit_fn visit,
+                                  void *userdata) {
+  history_args_t args;
+  build_history_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_history_argtable(&args);
+}
+
+
+/**
+ * Escapes special characters in a string for JSON output.
+ *
+ * @param str Input string to escape
+ * @param out Output buffer for escaped string
+ * @param out_size Size of output buffer
+ */
+static void escape_json_string(const char *str, char *out, size_t out_size) {
+  size_t j = 0;
+  for (size_t i = 0; str[i] && j < out_size - 1; i++) {
+    char c = str[i];
+    if (c == '"' || c == '\\') {
+      if (j + 2 >= out_size) break;
+      out[j++] = '\\';
+      out[j++] = c;
+    } else if (c == '\n') {
+      if (j + 2 >= out_size) break;
+      out[j++] = '\\';
+      out[j++] = 'n';
+    } else if (c == '\r') {
+      if (j + 2 >= out_size) break;
+      out[j++] = '\\';
+      out[j++] = 'r';
+    } else if (c == '\t') {
+      if (j + 2 >= out_size) break;
+      out[j++] = '\\';
+      out[j++] = 't';
+    } else {
+      out[j++] = c;
+    }
+  }
+  out[j] = '\0';
+}
+
+
+/**
+ * Context structure for printing history entries
+ */
+typedef struct {
+  int show_json;
+  int first;
+} history_print_ctx_t;
+
+
+/**
+ * Prints a single history entry in text or JSON format.
+ *
+ * @param index Zero-based history index
+ * @param entry History entry to print
+ * @param userdata Pointer to history_print_ctx_t context
+ */
+static void print_history_entry(size_t index, const JShellHistoryEntry *entry,
+                                void *userdata) {
+  history_print_ctx_t *ctx = (history_print_ctx_t *)userdata;
+
+  if (!ctx->show_json) {
+    jshell_printf("%5zu  %s\n", index + 1, entry->line);
+    return;
+  }
+
+  if (!ctx->first) {
+    jshell_printf(",\n");
+  }
+  ctx->first = 0;
+
+  char escaped_cmd[8192];
+  escape_json_string(entry->line, escaped_cmd, sizeof(escaped_cmd));
+
+  char started[32] = "";
+  struct tm tm_buf;
+  if (gmtime_r(&entry->timestamp, &tm_buf) != NULL) {
+    strftime(started, sizeof(started), "%Y-%m-%dT%H:%M:%SZ", &tm_buf);
+  }
+
+  jshell_printf("    {\"index\": %zu, \"command\": \"%s\", "
+                "\"started\": \"%s\", ",
+                index + 1, escaped_cmd, started);
+  if (entry->exit_status == JSHELL_HISTORY_STATUS_UNKNOWN) {
+    jshell_printf("\"exit_status\": null, ");
+  } else {
+    jshell_printf("\"exit_status\": %d, ", entry->exit_status);
+  }
+  jshell_printf("\"duration_us\": %llu}",
+                (unsigned long long)entry->duration_us);
+}
+
+
 /**
  * Executes the history command.
  *
@@ -79,7 +196,7 @@ static int history_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    history_print_usage(stdout);
+    history_print_usage(jshell_io_stdout());
     cleanup_history_argtable(&args);
     return 0;
   }
@@ -91,16 +208,38 @@ static int history_run(int argc, char **argv) {
     return 1;
   }
 
-  cleanup_history_argtable(&args);
+  if (args.search->count > 0 && args.prefix->count > 0) {
+    fprintf(stderr, "history: --search and --prefix are exclusive\n");
+    cleanup_history_argtable(&args);
+    return 1;
+  }
 
-  size_t count = jshell_history_count();
-  for (size_t i = 0; i < count; i++) {
-    const char *entry = jshell_history_get(i);
-    if (entry != NULL) {
-      printf("%5zu  %s\n", i + 1, entry);
+  history_print_ctx_t ctx = { .show_json = args.json->count > 0, .first = 1 };
+  if (ctx.show_json) {
+    jshell_printf("{\"history\": [\n");
+  }
+
+  if (args.search->count > 0) {
+    jshell_history_search(args.search->sval[0], HISTORY_MATCH_SUBSTRING,
+                          print_history_entry, &ctx);
+  } else if (args.prefix->count > 0) {
+    jshell_history_search(args.prefix->sval[0], HISTORY_MATCH_PREFIX,
+                          print_history_entry, &ctx);
+  } else {
+    size_t count = jshell_history_count();
+    for (size_t i = 0; i < count; i++) {
+      JShellHistoryEntry entry;
+      if (jshell_history_get_entry(i, &entry) == 0) {
+        print_history_entry(i, &entry, &ctx);
+      }
     }
   }
 
+  if (ctx.show_json) {
+    jshell_printf("%s  ]\n}\n", ctx.first ? "" : "\n");
+  }
+
+  cleanup_history_argtable(&args);
   return 0;
 }
 
@@ -111,11 +250,13 @@ static int history_run(int argc, char **argv) {
 const jshell_cmd_spec_t cmd_history_spec = {
   .name = "history",
   .summary = "display command history",
-  .long_help = "Display a numbered list of commands that have been entered "
-               "in the current shell session.",
+  .long_help = "Display a numbered list of commands entered in jshell, "
+               "optionally filtered by substring or prefix.\n"
+               "History persists in ~/.jshell/history across sessions.",
   .type = CMD_BUILTIN,
   .run = history_run,
-  .print_usage = history_print_usage
+  .print_usage = history_print_usage,
+  .describe_args = history_describe_args
 };
 
 
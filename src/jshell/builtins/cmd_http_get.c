@@ -3,14 +3,21 @@
  * @brief HTTP GET command implementation using libcurl
  */
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <curl/curl.h>
 
 #include "argtable3.h"
 #include "cmd_http_get.h"
+#include "jshell/jshell_io.h"
 #include "jshell/jshell_signals.h"
+#include "utils/jbox_http.h"
+#include "utils/jbox_http_cache.h"
 
 
 /**
@@ -20,20 +27,28 @@ typedef struct {
   struct arg_lit *help;
   struct arg_str *headers;
   struct arg_lit *json_output;
+  struct arg_file *output;
+  struct arg_lit *batch;
+  struct arg_int *jobs;
+  struct arg_lit *ordered;
+  struct arg_lit *cache;
+  struct arg_int *segments;
   struct arg_str *url;
   struct arg_end *end;
-  void *argtable[5];
+  void *argtable[11];
 } http_get_args_t;
 
 
 /**
- * Buffer for accumulating HTTP response body data.
+ * Destination the response body is written to as it arrives, and the
+ * cache file it is copied to, if any.
  */
 typedef struct {
-  char *data;
+  FILE *out;
   size_t size;
-  size_t capacity;
-} response_buffer_t;
+  FILE *copy;
+  int copy_failed;
+} response_sink_t;
 
 
 /**
@@ -55,14 +70,36 @@ static void build_http_get_argtable(http_get_args_t *args) {
   args->headers = arg_strn("H", "header", "KEY:VALUE", 0, 20,
                            "add header to request (repeatable)");
   args->json_output = arg_lit0(NULL, "json", "output response as JSON");
-  args->url = arg_str1(NULL, NULL, "URL", "URL to fetch");
+  args->output = arg_file0("o", "output", "FILE",
+                           "write the body to FILE instead of stdout");
+  args->batch = arg_lit0(NULL, "batch",
+                         "fetch every URL given, or each line of stdin, "
+                         "printing one JSON line per URL");
+  args->jobs = arg_int0("j", "jobs", "N",
+                        "with --batch, requests in flight at once "
+                        "(default 16)");
+  args->ordered = arg_lit0(NULL, "ordered",
+                           "with --batch, print results in input order");
+  args->cache = arg_lit0(NULL, "cache",
+                         "answer from ~/.jshell/http-cache while fresh, "
+                         "revalidating stale entries");
+  args->segments = arg_int0(NULL, "segments", "N",
+                            "with -o, fetch N byte ranges in parallel when "
+                            "the server allows it");
+  args->url = arg_strn(NULL, NULL, "URL", 0, 1024, "URL to fetch");
   args->end = arg_end(20);
 
   args->argtable[0] = args->help;
   args->argtable[1] = args->headers;
   args->argtable[2] = args->json_output;
-  args->argtable[3] = args->url;
-  args->argtable[4] = args->end;
+  args->argtable[3] = args->output;
+  args->argtable[4] = args->batch;
+  args->argtable[5] = args->jobs;
+  args->argtable[6] = args->ordered;
+  args->argtable[7] = args->cache;
+  args->argtable[8] = args->segments;
+  args->argtable[9] = args->url;
+  args->argtable[10] = args->end;
 }
 
 
@@ -92,39 +129,52 @@ static void http_get_print_usage(FILE *out) {
   fprintf(out, "  http-get https://example.com\n");
   fprintf(out, "  http-get -H \"Accept: application/json\" https://api.example.com\n");
   fprintf(out, "  http-get --json https://example.com\n");
+  fprintf(out, "  http-get -o image.iso https://example.com/image.iso\n");
+  fprintf(out, "  http-get -o image.iso --segments 8 "
+               "https://example.com/image.iso\n");
+  fprintf(out, "  http-get --cache https://example.com/docs/api.html\n");
+  fprintf(out, "  cat urls.txt | http-get --batch -j 32\n");
   cleanup_http_get_argtable(&args);
 }
 
 
 /**
- * Callback function for libcurl to write received data to a buffer.
+ * Passes the http-get argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void http_get_describe_args(jshell_argtable_visit_fn visit,
+                                   void *userdata) {
+  http_get_args_t args;
+  build_http_get_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_http_get_argtable(&args);
+}
+
+
+/**
+ * Callback function for libcurl to write received data to the sink, so
+ * the body is never held in memory.
  * @param contents Pointer to received data
  * @param size Size of each data element
  * @param nmemb Number of data elements
- * @param userp User pointer to response_buffer_t structure
+ * @param userp User pointer to response_sink_t structure
  * @return Number of bytes written, or 0 on error
  */
 static size_t write_callback(void *contents, size_t size, size_t nmemb,
                              void *userp) {
   size_t realsize = size * nmemb;
-  response_buffer_t *buf = (response_buffer_t *)userp;
+  response_sink_t *sink = (response_sink_t *)userp;
 
-  if (buf->size + realsize >= buf->capacity) {
-    size_t new_capacity = buf->capacity * 2;
-    if (new_capacity < buf->size + realsize + 1) {
-      new_capacity = buf->size + realsize + 1;
-    }
-    char *new_data = realloc(buf->data, new_capacity);
-    if (!new_data) {
-      return 0;
-    }
-    buf->data = new_data;
-    buf->capacity = new_capacity;
+  if (fwrite(contents, 1, realsize, sink->out) != realsize) {
+    return 0;
+  }
+  sink->size += realsize;
+  if (sink->copy && !sink->copy_failed
+      && fwrite(contents, 1, realsize, sink->copy) != realsize) {
+    sink->copy_failed = 1;
   }
-
-  memcpy(buf->data + buf->size, contents, realsize);
-  buf->size += realsize;
-  buf->data[buf->size] = '\0';
 
   return realsize;
 }
@@ -189,14 +239,15 @@ static void free_header_buffer(header_buffer_t *headers) {
 
 
 /**
- * Prints a string as properly escaped JSON.
+ * Prints bytes with JSON string escaping, without the quotes.
  * @param out Output stream
- * @param str String to print with JSON escaping
+ * @param data Bytes to print
+ * @param len Number of bytes
  */
-static void print_json_string(FILE *out, const char *str) {
-  fputc('"', out);
-  for (const char *p = str; *p; p++) {
-    switch (*p) {
+static void print_json_chars(FILE *out, const char *data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    char c = data[i];
+    switch (c) {
       case '"':  fputs("\\\"", out); break;
       case '\\': fputs("\\\\", out); break;
       case '\b': fputs("\\b", out); break;
@@ -205,14 +256,44 @@ static void print_json_string(FILE *out, const char *str) {
       case '\r': fputs("\\r", out); break;
       case '\t': fputs("\\t", out); break;
       default:
-        if ((unsigned char)*p < 0x20) {
-          fprintf(out, "\\u%04x", (unsigned char)*p);
+        if ((unsigned char)c < 0x20) {
+          fprintf(out, "\\u%04x", (unsigned char)c);
         } else {
-          fputc(*p, out);
+          fputc(c, out);
         }
         break;
     }
   }
+}
+
+
+/**
+ * Prints a string as properly escaped JSON.
+ * @param out Output stream
+ * @param str String to print with JSON escaping
+ */
+static void print_json_string(FILE *out, const char *str) {
+  fputc('"', out);
+  print_json_chars(out, str, strlen(str));
+  fputc('"', out);
+}
+
+
+/**
+ * Prints the contents of a file as an escaped JSON string, a block at a
+ * time.
+ * @param out Output stream
+ * @param in File to read from its start
+ */
+static void print_json_file(FILE *out, FILE *in) {
+  char block[8192];
+  size_t n;
+
+  rewind(in);
+  fputc('"', out);
+  while ((n = fread(block, 1, sizeof(block), in)) > 0) {
+    print_json_chars(out, block, n);
+  }
   fputc('"', out);
 }
 
@@ -242,6 +323,362 @@ static int progress_callback(void *clientp, curl_off_t dltotal,
 }
 
 
+/**
+ * Reads the URLs of a batch from stdin, one per line, skipping blank
+ * lines and lines starting with '#'.
+ * @param count Set to the number of URLs read
+ * @return Allocated array of allocated URLs, or NULL on error
+ */
+static char **read_batch_urls(size_t *count) {
+  size_t cap = 64;
+  size_t n = 0;
+  char **urls = malloc(cap * sizeof(char *));
+  if (urls == NULL) {
+    return NULL;
+  }
+
+  char *line = NULL;
+  size_t line_cap = 0;
+  ssize_t len;
+  FILE *in = jshell_io_stdin();
+
+  while ((len = getline(&line, &line_cap, in)) != -1) {
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+      line[--len] = '\0';
+    }
+    if (len == 0 || line[0] == '#') {
+      continue;
+    }
+    if (n == cap) {
+      cap *= 2;
+      char **grown = realloc(urls, cap * sizeof(char *));
+      if (grown == NULL) {
+        break;
+      }
+      urls = grown;
+    }
+    urls[n] = strdup(line);
+    if (urls[n] == NULL) {
+      break;
+    }
+    n++;
+  }
+
+  free(line);
+  *count = n;
+  return urls;
+}
+
+
+/**
+ * Prints the outcome of one request of a batch as a JSON line.
+ * @param response Outcome of the request
+ * @param ctx Unused
+ */
+static void print_batch_response(const jbox_http_response_t *response,
+                                 void *ctx) {
+  (void)ctx;
+  FILE *out = jshell_io_stdout();
+
+  fprintf(out, "{\"index\":%zu,\"url\":", response->index);
+  print_json_string(out, response->url);
+  if (response->result == CURLE_OK) {
+    fprintf(out, ",\"status\":\"ok\",\"http_code\":%ld",
+            response->http_code);
+    if (response->content_type) {
+      fprintf(out, ",\"content_type\":");
+      print_json_string(out, response->content_type);
+    }
+    fprintf(out, ",\"time\":%.3f,\"body\":\"", response->seconds);
+    print_json_chars(out, response->body, response->body_size);
+    fprintf(out, "\"}\n");
+  } else {
+    fprintf(out, ",\"status\":\"%s\",\"code\":%d,\"message\":",
+            response->result == CURLE_ABORTED_BY_CALLBACK ? "interrupted"
+                                                          : "error",
+            (int)response->result);
+    print_json_string(out, curl_easy_strerror(response->result));
+    fprintf(out, "}\n");
+  }
+  fflush(out);
+}
+
+
+/**
+ * Fetches many URLs at once for http-get --batch.
+ * @param args Parsed arguments
+ * @param req_headers Request headers, or NULL
+ * @return Exit status: 0 if every request succeeded, 130 if interrupted,
+ *         1 otherwise
+ */
+static int http_get_batch(http_get_args_t *args,
+                          struct curl_slist *req_headers) {
+  size_t count = (size_t)args->url->count;
+  char **stdin_urls = NULL;
+  if (count == 0) {
+    stdin_urls = read_batch_urls(&count);
+    if (stdin_urls == NULL) {
+      fprintf(stderr, "http-get: out of memory\n");
+      return 1;
+    }
+  }
+
+  jbox_http_request_t *requests = calloc(count > 0 ? count : 1,
+                                         sizeof(jbox_http_request_t));
+  if (requests == NULL) {
+    fprintf(stderr, "http-get: out of memory\n");
+    count = 0;
+  }
+  for (size_t i = 0; requests && i < count; i++) {
+    requests[i].url = stdin_urls ? stdin_urls[i] : args->url->sval[i];
+  }
+
+  jbox_http_batch_opts_t opts = {
+    .headers = req_headers,
+    .user_agent = "jbox-http-get/1.0",
+    .max_parallel = args->jobs->count > 0 ? args->jobs->ival[0] : 0,
+    .in_order = args->ordered->count > 0,
+    .interrupted = jshell_is_interrupted
+  };
+  int failed = requests ? jbox_http_batch(requests, count, &opts,
+                                          print_batch_response, NULL)
+                        : -1;
+
+  free(requests);
+  for (size_t i = 0; stdin_urls && i < count; i++) {
+    free(stdin_urls[i]);
+  }
+  free(stdin_urls);
+
+  if (jshell_is_interrupted()) {
+    return 130;
+  }
+  return failed == 0 ? 0 : 1;
+}
+
+
+/**
+ * Finds the headers of the last response of a transfer, skipping those
+ * of any redirects before it.
+ * @param headers Every header line received, status lines included
+ * @return Index of the first header line after the last status line
+ */
+static size_t final_headers(const header_buffer_t *headers) {
+  size_t first = 0;
+  for (size_t i = 0; i < headers->count; i++) {
+    if (strncmp(headers->headers[i], "HTTP/", 5) == 0) {
+      first = i + 1;
+    }
+  }
+  return first;
+}
+
+
+/**
+ * Prints "Name: value" header lines as a JSON object, skipping lines
+ * without a colon.
+ * @param out Output stream
+ * @param headers Header lines
+ * @param count Number of lines
+ */
+static void print_json_headers(FILE *out, char *const *headers,
+                               size_t count) {
+  int first_header = 1;
+  fputc('{', out);
+  for (size_t i = 0; i < count; i++) {
+    const char *colon = strchr(headers[i], ':');
+    if (colon) {
+      if (!first_header) fputc(',', out);
+      first_header = 0;
+
+      const char *value = colon + 1;
+      while (*value == ' ') value++;
+
+      fputc('"', out);
+      print_json_chars(out, headers[i], (size_t)(colon - headers[i]));
+      fputs("\":", out);
+      print_json_string(out, value);
+    }
+  }
+  fputc('}', out);
+}
+
+
+/**
+ * Opens the stream the response body is written to, reporting failure.
+ * @param output_path File to write, or NULL
+ * @param json_output Whether --json was given
+ * @return output_path, a temporary file for --json without a file, or
+ *         stdout; NULL on error
+ */
+static FILE *open_output(const char *output_path, int json_output) {
+  FILE *out;
+  if (output_path) {
+    out = fopen(output_path, "wb");
+  } else if (json_output) {
+    out = tmpfile();
+  } else {
+    out = jshell_io_stdout();
+  }
+  if (!out) {
+    if (json_output) {
+      jshell_printf("{\"status\":\"error\",\"message\":");
+      print_json_string(jshell_io_stdout(), strerror(errno));
+      jshell_printf("}\n");
+    } else {
+      fprintf(stderr, "http-get: %s: %s\n",
+              output_path ? output_path : "temporary file", strerror(errno));
+    }
+  }
+  return out;
+}
+
+
+/**
+ * Prints a response answered from the cache, writing the mapped body
+ * out in one go.
+ * @param entry Cache entry holding the response
+ * @param state "hit" or "revalidated", reported by --json
+ * @param json_output Whether --json was given
+ * @param output_path File to write the body to, or NULL
+ * @param out Stream open on output_path, or NULL to open it here
+ * @return Exit status (0 on success, non-zero on error)
+ */
+static int print_cached(const jbox_http_cache_entry_t *entry,
+                        const char *state, int json_output,
+                        const char *output_path, FILE *out) {
+  if (output_path || !json_output) {
+    FILE *dest = out ? out : open_output(output_path, json_output);
+    if (!dest) {
+      return 1;
+    }
+    int failed = (entry->body_size > 0
+                  && fwrite(entry->body, 1, entry->body_size, dest)
+                     != entry->body_size)
+                 || fflush(dest) != 0;
+    int saved_errno = errno;
+    if (!out && output_path) {
+      failed |= fclose(dest) != 0;
+    }
+    if (failed) {
+      fprintf(stderr, "http-get: %s: %s\n",
+              output_path ? output_path : "stdout", strerror(saved_errno));
+      return 1;
+    }
+  }
+
+  if (json_output) {
+    jshell_printf("{\"status\":\"ok\",\"http_code\":%ld,\"cache\":\"%s\"",
+                  entry->http_code, state);
+
+    const char *content_type = jbox_http_cache_header(
+        entry->headers, entry->header_count, "Content-Type");
+    if (content_type) {
+      jshell_printf(",\"content_type\":");
+      print_json_string(jshell_io_stdout(), content_type);
+    }
+
+    jshell_printf(",\"headers\":");
+    print_json_headers(jshell_io_stdout(), entry->headers,
+                       entry->header_count);
+
+    if (output_path) {
+      jshell_printf(",\"file\":");
+      print_json_string(jshell_io_stdout(), output_path);
+      jshell_printf(",\"size\":%zu}\n", entry->body_size);
+    } else {
+      jshell_printf(",\"body\":\"");
+      print_json_chars(jshell_io_stdout(), entry->body ? entry->body : "",
+                       entry->body_size);
+      jshell_printf("\"}\n");
+    }
+  }
+
+  return entry->http_code >= 400 ? 1 : 0;
+}
+
+
+/**
+ * Downloads a URL into a file as parallel byte ranges, for --segments.
+ * @param url URL to fetch
+ * @param output_path File to write
+ * @param segments Ranges to fetch at once
+ * @param req_headers Request headers, or NULL
+ * @param json_output Whether --json was given
+ * @param ret Set to the exit status when the download was handled
+ * @return 0 if handled (successfully or not), 1 if the server cannot
+ *         serve ranges and the file should be fetched as one stream
+ */
+static int http_get_segmented(const char *url, const char *output_path,
+                              int segments, struct curl_slist *req_headers,
+                              int json_output, int *ret) {
+  int fd = open(output_path, O_WRONLY | O_CREAT, 0666);
+  if (fd < 0) {
+    if (json_output) {
+      jshell_printf("{\"status\":\"error\",\"message\":");
+      print_json_string(jshell_io_stdout(), strerror(errno));
+      jshell_printf("}\n");
+    } else {
+      fprintf(stderr, "http-get: %s: %s\n", output_path, strerror(errno));
+    }
+    *ret = 1;
+    return 0;
+  }
+
+  jbox_http_segment_opts_t opts = {
+    .headers = req_headers,
+    .user_agent = "jbox-http-get/1.0",
+    .interrupted = jshell_is_interrupted
+  };
+  jbox_http_segment_result_t result;
+  int rc = jbox_http_download_segments(url, fd, segments, &opts, &result);
+  if (close(fd) != 0 && rc == 0) {
+    rc = -1;
+    result.result = CURLE_WRITE_ERROR;
+  }
+  if (rc == JBOX_HTTP_NO_RANGES) {
+    return 1;
+  }
+
+  if (rc == 0) {
+    if (json_output) {
+      jshell_printf("{\"status\":\"ok\",\"http_code\":%ld,\"file\":",
+                    result.http_code);
+      print_json_string(jshell_io_stdout(), output_path);
+      jshell_printf(",\"size\":%" CURL_FORMAT_CURL_OFF_T
+                    ",\"segments\":%d,\"retries\":%d}\n",
+                    result.size, result.segments, result.retries);
+    }
+    *ret = 0;
+  } else if (result.result == CURLE_ABORTED_BY_CALLBACK) {
+    if (json_output) {
+      jshell_printf("{\"status\":\"interrupted\","
+                    "\"message\":\"Transfer interrupted\"}\n");
+    } else {
+      fprintf(stderr, "http-get: transfer interrupted\n");
+    }
+    *ret = 130;  /* 128 + SIGINT(2) */
+  } else {
+    const char *message = result.result != CURLE_OK
+                          ? curl_easy_strerror(result.result)
+                          : "HTTP error";
+    if (json_output) {
+      jshell_printf("{\"status\":\"error\",\"code\":%d,"
+                    "\"http_code\":%ld,\"message\":",
+                    (int)result.result, result.http_code);
+      print_json_string(jshell_io_stdout(), message);
+      jshell_printf("}\n");
+    } else if (result.result != CURLE_OK) {
+      fprintf(stderr, "http-get: %s\n", message);
+    } else {
+      fprintf(stderr, "http-get: HTTP %ld\n", result.http_code);
+    }
+    *ret = 1;
+  }
+  return 0;
+}
+
+
 /**
  * Main execution function for the http-get command.
  * @param argc Argument count
@@ -255,7 +692,7 @@ static int http_get_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    http_get_print_usage(stdout);
+    http_get_print_usage(jshell_io_stdout());
     cleanup_http_get_argtable(&args);
     return 0;
   }
@@ -267,31 +704,113 @@ static int http_get_run(int argc, char **argv) {
     return 1;
   }
 
+  int segments = args.segments->count > 0 ? args.segments->ival[0] : 1;
+  if (segments < 1 || segments > JBOX_HTTP_MAX_SEGMENTS) {
+    fprintf(stderr, "http-get: --segments must be between 1 and %d\n",
+            JBOX_HTTP_MAX_SEGMENTS);
+    cleanup_http_get_argtable(&args);
+    return 1;
+  }
+  if (segments > 1 && (args.output->count == 0 || args.batch->count > 0
+                       || args.cache->count > 0)) {
+    fprintf(stderr, "http-get: --segments needs -o FILE and cannot be used "
+                    "with --batch or --cache\n");
+    cleanup_http_get_argtable(&args);
+    return 1;
+  }
+
+  if (args.batch->count > 0) {
+    if (args.output->count > 0) {
+      fprintf(stderr, "http-get: --output cannot be used with --batch\n");
+      cleanup_http_get_argtable(&args);
+      return 1;
+    }
+    struct curl_slist *req_headers = NULL;
+    for (int i = 0; i < args.headers->count; i++) {
+      req_headers = curl_slist_append(req_headers, args.headers->sval[i]);
+    }
+    int ret = http_get_batch(&args, req_headers);
+    curl_slist_free_all(req_headers);
+    cleanup_http_get_argtable(&args);
+    return ret;
+  }
+
+  if (args.url->count != 1) {
+    fprintf(stderr, "http-get: expected one URL (use --batch for several)\n");
+    fprintf(stderr, "Try 'http-get --help' for more information.\n");
+    cleanup_http_get_argtable(&args);
+    return 1;
+  }
+
   const char *url = args.url->sval[0];
   int json_output = args.json_output->count > 0;
+  const char *output_path = args.output->count > 0
+                            ? args.output->filename[0] : NULL;
 
-  CURL *curl = curl_easy_init();
+  struct curl_slist *req_headers = NULL;
+  for (int i = 0; i < args.headers->count; i++) {
+    req_headers = curl_slist_append(req_headers, args.headers->sval[i]);
+  }
+
+  /* Split into ranges where the server allows it; otherwise fall
+   * through to one stream */
+  if (segments > 1) {
+    int ret = 0;
+    if (http_get_segmented(url, output_path, segments, req_headers,
+                           json_output, &ret) == 0) {
+      curl_slist_free_all(req_headers);
+      cleanup_http_get_argtable(&args);
+      return ret;
+    }
+  }
+
+  /* With --cache, a fresh stored response is answered without asking the
+   * server, and a stale one is revalidated with its validators */
+  jbox_http_cache_entry_t cached = {0};
+  const char *cache_state = args.cache->count > 0 ? "miss" : NULL;
+  int use_cache = cache_state
+                  && jbox_http_cache_open(&cached, url, req_headers) == 0;
+  if (use_cache && jbox_http_cache_is_fresh(&cached, time(NULL))) {
+    int ret = print_cached(&cached, "hit", json_output, output_path, NULL);
+    jbox_http_cache_close(&cached);
+    curl_slist_free_all(req_headers);
+    cleanup_http_get_argtable(&args);
+    return ret;
+  }
+  if (use_cache) {
+    req_headers = jbox_http_cache_conditional(&cached, req_headers);
+  }
+
+  CURL *curl = jbox_http_acquire();
   if (!curl) {
     if (json_output) {
-      printf("{\"status\":\"error\",\"message\":\"Failed to initialize curl\"}\n");
+      jshell_printf("{\"status\":\"error\","
+                    "\"message\":\"Failed to initialize curl\"}\n");
     } else {
       fprintf(stderr, "http-get: failed to initialize curl\n");
     }
+    jbox_http_cache_close(&cached);
+    curl_slist_free_all(req_headers);
     cleanup_http_get_argtable(&args);
     return 1;
   }
 
-  response_buffer_t response = {
-    .data = malloc(4096),
-    .size = 0,
-    .capacity = 4096
-  };
-  if (!response.data) {
-    curl_easy_cleanup(curl);
+  /* The body goes straight to FILE or stdout as it arrives; for --json
+   * without a file it is spooled to a temporary file and escaped from
+   * there once the headers and status are known */
+  response_sink_t response = {0};
+  response.out = open_output(output_path, json_output);
+  if (!response.out) {
+    jbox_http_cache_close(&cached);
+    curl_slist_free_all(req_headers);
+    jbox_http_release(curl);
     cleanup_http_get_argtable(&args);
     return 1;
   }
-  response.data[0] = '\0';
+  int own_output = output_path || json_output;
+  if (use_cache) {
+    response.copy = jbox_http_cache_begin(&cached);
+  }
 
   header_buffer_t resp_headers = {
     .headers = malloc(32 * sizeof(char *)),
@@ -299,8 +818,10 @@ static int http_get_run(int argc, char **argv) {
     .capacity = 32
   };
   if (!resp_headers.headers) {
-    free(response.data);
-    curl_easy_cleanup(curl);
+    if (own_output) fclose(response.out);
+    jbox_http_cache_close(&cached);
+    curl_slist_free_all(req_headers);
+    jbox_http_release(curl);
     cleanup_http_get_argtable(&args);
     return 1;
   }
@@ -319,15 +840,14 @@ static int http_get_run(int argc, char **argv) {
   curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, progress_callback);
   curl_easy_setopt(curl, CURLOPT_XFERINFODATA, NULL);
 
-  struct curl_slist *req_headers = NULL;
-  for (int i = 0; i < args.headers->count; i++) {
-    req_headers = curl_slist_append(req_headers, args.headers->sval[i]);
-  }
   if (req_headers) {
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, req_headers);
   }
 
   CURLcode res = curl_easy_perform(curl);
+  if (own_output && fflush(response.out) != 0 && res == CURLE_OK) {
+    res = CURLE_WRITE_ERROR;
+  }
 
   long http_code = 0;
   curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
@@ -335,60 +855,70 @@ static int http_get_run(int argc, char **argv) {
   char *content_type = NULL;
   curl_easy_getinfo(curl, CURLINFO_CONTENT_TYPE, &content_type);
 
+  /* Headers of the last response, after any redirects */
+  size_t first = final_headers(&resp_headers);
+  if (use_cache && res == CURLE_OK) {
+    if (http_code == 304 && cached.found) {
+      jbox_http_cache_refresh(&cached, url, resp_headers.headers + first,
+                              resp_headers.count - first);
+      if (cached.found) {
+        cache_state = "revalidated";
+      }
+    } else if (!response.copy_failed) {
+      jbox_http_cache_commit(&cached, url, http_code,
+                             resp_headers.headers + first,
+                             resp_headers.count - first);
+    }
+  }
+
   int ret = 0;
 
   if (res == CURLE_ABORTED_BY_CALLBACK) {
     /* Transfer was interrupted by signal */
     if (json_output) {
-      printf("{\"status\":\"interrupted\",\"message\":\"Transfer interrupted\"}\n");
+      jshell_printf("{\"status\":\"interrupted\","
+                    "\"message\":\"Transfer interrupted\"}\n");
     } else {
       fprintf(stderr, "http-get: transfer interrupted\n");
     }
     ret = 130;  /* 128 + SIGINT(2) */
   } else if (res != CURLE_OK) {
     if (json_output) {
-      printf("{\"status\":\"error\",\"code\":%d,\"message\":", (int)res);
-      print_json_string(stdout, curl_easy_strerror(res));
-      printf("}\n");
+      jshell_printf("{\"status\":\"error\",\"code\":%d,\"message\":", (int)res);
+      print_json_string(jshell_io_stdout(), curl_easy_strerror(res));
+      jshell_printf("}\n");
     } else {
       fprintf(stderr, "http-get: %s\n", curl_easy_strerror(res));
     }
     ret = 1;
+  } else if (strcmp(cache_state ? cache_state : "", "revalidated") == 0) {
+    ret = print_cached(&cached, cache_state, json_output, output_path,
+                       response.out);
   } else {
     if (json_output) {
-      printf("{\"status\":\"ok\",\"http_code\":%ld", http_code);
+      jshell_printf("{\"status\":\"ok\",\"http_code\":%ld", http_code);
+      if (cache_state) {
+        jshell_printf(",\"cache\":\"%s\"", cache_state);
+      }
 
       if (content_type) {
-        printf(",\"content_type\":");
-        print_json_string(stdout, content_type);
+        jshell_printf(",\"content_type\":");
+        print_json_string(jshell_io_stdout(), content_type);
       }
 
-      printf(",\"headers\":{");
-      int first_header = 1;
-      for (size_t i = 1; i < resp_headers.count; i++) {
-        char *colon = strchr(resp_headers.headers[i], ':');
-        if (colon) {
-          if (!first_header) printf(",");
-          first_header = 0;
-
-          *colon = '\0';
-          char *value = colon + 1;
-          while (*value == ' ') value++;
-
-          print_json_string(stdout, resp_headers.headers[i]);
-          printf(":");
-          print_json_string(stdout, value);
-
-          *colon = ':';
-        }
+      jshell_printf(",\"headers\":");
+      print_json_headers(jshell_io_stdout(), resp_headers.headers + 1,
+                         resp_headers.count > 0 ? resp_headers.count - 1 : 0);
+
+      if (output_path) {
+        jshell_printf(",\"file\":");
+        print_json_string(jshell_io_stdout(), output_path);
+        jshell_printf(",\"size\":%zu}\n", response.size);
+      } else {
+        jshell_printf(",\"body\":");
+        print_json_file(jshell_io_stdout(), response.out);
+        jshell_printf("}\n");
       }
-      printf("}");
-
-      printf(",\"body\":");
-      print_json_string(stdout, response.data);
-      printf("}\n");
-    } else {
-      printf("%s", response.data);
     }
 
     if (http_code >= 400) {
@@ -400,8 +930,11 @@ static int http_get_run(int argc, char **argv) {
     curl_slist_free_all(req_headers);
   }
   free_header_buffer(&resp_headers);
-  free(response.data);
-  curl_easy_cleanup(curl);
+  if (own_output) {
+    fclose(response.out);
+  }
+  jbox_http_cache_close(&cached);
+  jbox_http_release(curl);
   cleanup_http_get_argtable(&args);
 
   return ret;
@@ -415,10 +948,17 @@ const jshell_cmd_spec_t cmd_http_get_spec = {
   .name = "http-get",
   .summary = "fetch content from a URL using HTTP GET",
   .long_help = "Fetch content from a URL using HTTP GET. "
-               "Supports custom headers and JSON output format.",
+               "The body is streamed to stdout or to a file as it "
+               "arrives. Supports custom headers and JSON output format. "
+               "With --batch, fetches many URLs concurrently. With -o and "
+               "--segments N, a large file is fetched as N byte ranges "
+               "over parallel connections. With "
+               "--cache, responses are kept in ~/.jshell/http-cache and "
+               "reused or revalidated as their headers allow.",
   .type = CMD_BUILTIN,
   .run = http_get_run,
-  .print_usage = http_get_print_usage
+  .print_usage = http_get_print_usage,
+  .describe_args = http_get_describe_args
 };
 
 
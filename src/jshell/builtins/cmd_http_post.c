@@ -3,14 +3,21 @@
  * @brief HTTP POST command implementation using libcurl
  */
 
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <curl/curl.h>
+#include <zlib.h>
 
 #include "argtable3.h"
 #include "cmd_http_post.h"
+#include "jshell/jshell_io.h"
 #include "jshell/jshell_signals.h"
+#include "utils/jbox_http.h"
 
 
 /**
@@ -20,10 +27,15 @@ typedef struct {
   struct arg_lit *help;
   struct arg_str *headers;
   struct arg_str *data;
+  struct arg_file *data_file;
+  struct arg_lit *gzip;
   struct arg_lit *json_output;
+  struct arg_lit *batch;
+  struct arg_int *jobs;
+  struct arg_lit *ordered;
   struct arg_str *url;
   struct arg_end *end;
-  void *argtable[6];
+  void *argtable[11];
 } http_post_args_t;
 
 
@@ -37,6 +49,23 @@ typedef struct {
 } response_buffer_t;
 
 
+/**
+ * Request body handed to libcurl a piece at a time, read from a file or
+ * from memory and optionally gzip-compressed on the way.
+ */
+typedef struct {
+  FILE *in;                  /* Source file, or NULL to send data */
+  const char *data;
+  size_t data_len;
+  size_t data_pos;
+  bool gzip;
+  z_stream zs;
+  bool eof;                  /* Source exhausted */
+  bool finished;             /* Compressed stream complete */
+  unsigned char chunk[16384];
+} request_body_t;
+
+
 /**
  * Buffer for accumulating HTTP response headers.
  */
@@ -56,16 +85,34 @@ static void build_http_post_argtable(http_post_args_t *args) {
   args->headers = arg_strn("H", "header", "KEY:VALUE", 0, 20,
                            "add header to request (repeatable)");
   args->data = arg_str0("d", "data", "DATA", "request body data");
+  args->data_file = arg_file0("f", "data-file", "FILE",
+                              "stream the request body from FILE "
+                              "('-' for stdin)");
+  args->gzip = arg_lit0(NULL, "gzip", "gzip-compress the request body");
   args->json_output = arg_lit0(NULL, "json", "output response as JSON");
-  args->url = arg_str1(NULL, NULL, "URL", "URL to post to");
+  args->batch = arg_lit0(NULL, "batch",
+                         "post to every URL given, or each line of stdin "
+                         "(URL, or URL<TAB>DATA), printing one JSON line "
+                         "per URL");
+  args->jobs = arg_int0("j", "jobs", "N",
+                        "with --batch, requests in flight at once "
+                        "(default 16)");
+  args->ordered = arg_lit0(NULL, "ordered",
+                           "with --batch, print results in input order");
+  args->url = arg_strn(NULL, NULL, "URL", 0, 1024, "URL to post to");
   args->end = arg_end(20);
 
   args->argtable[0] = args->help;
   args->argtable[1] = args->headers;
   args->argtable[2] = args->data;
-  args->argtable[3] = args->json_output;
-  args->argtable[4] = args->url;
-  args->argtable[5] = args->end;
+  args->argtable[3] = args->data_file;
+  args->argtable[4] = args->gzip;
+  args->argtable[5] = args->json_output;
+  args->argtable[6] = args->batch;
+  args->argtable[7] = args->jobs;
+  args->argtable[8] = args->ordered;
+  args->argtable[9] = args->url;
+  args->argtable[10] = args->end;
 }
 
 
@@ -96,6 +143,23 @@ static void http_post_print_usage(FILE *out) {
   fprintf(out, "  http-post -H \"Content-Type: application/json\" "
                "-d '{\"name\":\"test\"}' https://api.example.com\n");
   fprintf(out, "  http-post --json -d 'data' https://example.com\n");
+  fprintf(out, "  http-post --gzip -f logs.json https://logs.example.com\n");
+  fprintf(out, "  cat requests.tsv | http-post --batch --ordered\n");
+  cleanup_http_post_argtable(&args);
+}
+
+
+/**
+ * Passes the http-post argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void http_post_describe_args(jshell_argtable_visit_fn visit,
+                                    void *userdata) {
+  http_post_args_t args;
+  build_http_post_argtable(&args);
+  visit(args.argtable, userdata);
   cleanup_http_post_argtable(&args);
 }
 
@@ -193,14 +257,15 @@ static void free_header_buffer(header_buffer_t *headers) {
 
 
 /**
- * Prints a string as properly escaped JSON.
+ * Prints bytes with JSON string escaping, without the quotes.
  * @param out Output stream
- * @param str String to print with JSON escaping
+ * @param data Bytes to print
+ * @param len Number of bytes
  */
-static void print_json_string(FILE *out, const char *str) {
-  fputc('"', out);
-  for (const char *p = str; *p; p++) {
-    switch (*p) {
+static void print_json_chars(FILE *out, const char *data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    char c = data[i];
+    switch (c) {
       case '"':  fputs("\\\"", out); break;
       case '\\': fputs("\\\\", out); break;
       case '\b': fputs("\\b", out); break;
@@ -209,14 +274,25 @@ static void print_json_string(FILE *out, const char *str) {
       case '\r': fputs("\\r", out); break;
       case '\t': fputs("\\t", out); break;
       default:
-        if ((unsigned char)*p < 0x20) {
-          fprintf(out, "\\u%04x", (unsigned char)*p);
+        if ((unsigned char)c < 0x20) {
+          fprintf(out, "\\u%04x", (unsigned char)c);
         } else {
-          fputc(*p, out);
+          fputc(c, out);
         }
         break;
     }
   }
+}
+
+
+/**
+ * Prints a string as properly escaped JSON.
+ * @param out Output stream
+ * @param str String to print with JSON escaping
+ */
+static void print_json_string(FILE *out, const char *str) {
+  fputc('"', out);
+  print_json_chars(out, str, strlen(str));
   fputc('"', out);
 }
 
@@ -246,6 +322,252 @@ static int progress_callback(void *clientp, curl_off_t dltotal,
 }
 
 
+/**
+ * Reads up to len bytes of the request body's source.
+ * @param body Request body
+ * @param buf Destination
+ * @param len Most bytes to read
+ * @return Bytes read, 0 at the end, or -1 on a read error
+ */
+static ssize_t read_body_source(request_body_t *body, void *buf,
+                                size_t len) {
+  if (body->in) {
+    size_t n = fread(buf, 1, len, body->in);
+    return n == 0 && ferror(body->in) ? -1 : (ssize_t)n;
+  }
+  size_t left = body->data_len - body->data_pos;
+  size_t n = left < len ? left : len;
+  memcpy(buf, body->data + body->data_pos, n);
+  body->data_pos += n;
+  return (ssize_t)n;
+}
+
+
+/**
+ * Callback for libcurl to read the next piece of the request body.
+ * @param buffer Destination for the body
+ * @param size Size of each data element
+ * @param nitems Number of data elements
+ * @param userp User pointer to request_body_t structure
+ * @return Bytes placed in buffer, 0 at the end, or CURL_READFUNC_ABORT
+ */
+static size_t read_callback(char *buffer, size_t size, size_t nitems,
+                            void *userp) {
+  request_body_t *body = (request_body_t *)userp;
+  size_t max = size * nitems;
+
+  if (!body->gzip) {
+    ssize_t n = read_body_source(body, buffer, max);
+    return n < 0 ? CURL_READFUNC_ABORT : (size_t)n;
+  }
+
+  uInt room = (uInt)(max < UINT_MAX ? max : UINT_MAX);
+  body->zs.next_out = (Bytef *)buffer;
+  body->zs.avail_out = room;
+
+  /* Compress until some output is ready or the stream is complete */
+  while (!body->finished && body->zs.avail_out == room) {
+    if (body->zs.avail_in == 0 && !body->eof) {
+      ssize_t n = read_body_source(body, body->chunk, sizeof(body->chunk));
+      if (n < 0) {
+        return CURL_READFUNC_ABORT;
+      }
+      body->eof = n == 0;
+      body->zs.next_in = body->chunk;
+      body->zs.avail_in = (uInt)n;
+    }
+    int ret = deflate(&body->zs, body->eof ? Z_FINISH : Z_NO_FLUSH);
+    if (ret == Z_STREAM_END) {
+      body->finished = true;
+    } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+      return CURL_READFUNC_ABORT;
+    }
+  }
+
+  return room - body->zs.avail_out;
+}
+
+
+/**
+ * Callback for libcurl to rewind the request body, e.g. to send it
+ * again after a redirect.
+ * @param userp User pointer to request_body_t structure
+ * @param offset Offset to seek to
+ * @param origin SEEK_SET, SEEK_CUR or SEEK_END
+ * @return CURL_SEEKFUNC_OK, or CURL_SEEKFUNC_CANTSEEK
+ */
+static int seek_callback(void *userp, curl_off_t offset, int origin) {
+  request_body_t *body = (request_body_t *)userp;
+
+  if (body->gzip) {
+    /* A compressed body can only be restarted from the beginning */
+    if (offset != 0 || origin != SEEK_SET
+        || (body->in && fseek(body->in, 0, SEEK_SET) != 0)
+        || deflateReset(&body->zs) != Z_OK) {
+      return CURL_SEEKFUNC_CANTSEEK;
+    }
+    body->data_pos = 0;
+    body->zs.avail_in = 0;
+    body->eof = false;
+    body->finished = false;
+    return CURL_SEEKFUNC_OK;
+  }
+
+  if (body->in) {
+    return fseeko(body->in, (off_t)offset, origin) == 0
+           ? CURL_SEEKFUNC_OK : CURL_SEEKFUNC_CANTSEEK;
+  }
+  if (origin != SEEK_SET || offset < 0 || (size_t)offset > body->data_len) {
+    return CURL_SEEKFUNC_CANTSEEK;
+  }
+  body->data_pos = (size_t)offset;
+  return CURL_SEEKFUNC_OK;
+}
+
+
+/**
+ * Reads the requests of a batch from stdin, one per line: a URL, or a
+ * URL, a tab and the data to post. Blank lines and lines starting with
+ * '#' are skipped.
+ * @param count Set to the number of lines read
+ * @return Allocated array of allocated lines, or NULL on error
+ */
+static char **read_batch_lines(size_t *count) {
+  size_t cap = 64;
+  size_t n = 0;
+  char **lines = malloc(cap * sizeof(char *));
+  if (lines == NULL) {
+    return NULL;
+  }
+
+  char *line = NULL;
+  size_t line_cap = 0;
+  ssize_t len;
+  FILE *in = jshell_io_stdin();
+
+  while ((len = getline(&line, &line_cap, in)) != -1) {
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+      line[--len] = '\0';
+    }
+    if (len == 0 || line[0] == '#') {
+      continue;
+    }
+    if (n == cap) {
+      cap *= 2;
+      char **grown = realloc(lines, cap * sizeof(char *));
+      if (grown == NULL) {
+        break;
+      }
+      lines = grown;
+    }
+    lines[n] = strdup(line);
+    if (lines[n] == NULL) {
+      break;
+    }
+    n++;
+  }
+
+  free(line);
+  *count = n;
+  return lines;
+}
+
+
+/**
+ * Prints the outcome of one request of a batch as a JSON line.
+ * @param response Outcome of the request
+ * @param ctx Unused
+ */
+static void print_batch_response(const jbox_http_response_t *response,
+                                 void *ctx) {
+  (void)ctx;
+  FILE *out = jshell_io_stdout();
+
+  fprintf(out, "{\"index\":%zu,\"url\":", response->index);
+  print_json_string(out, response->url);
+  if (response->result == CURLE_OK) {
+    fprintf(out, ",\"status\":\"ok\",\"http_code\":%ld",
+            response->http_code);
+    if (response->content_type) {
+      fprintf(out, ",\"content_type\":");
+      print_json_string(out, response->content_type);
+    }
+    fprintf(out, ",\"time\":%.3f,\"body\":\"", response->seconds);
+    print_json_chars(out, response->body, response->body_size);
+    fprintf(out, "\"}\n");
+  } else {
+    fprintf(out, ",\"status\":\"%s\",\"code\":%d,\"message\":",
+            response->result == CURLE_ABORTED_BY_CALLBACK ? "interrupted"
+                                                          : "error",
+            (int)response->result);
+    print_json_string(out, curl_easy_strerror(response->result));
+    fprintf(out, "}\n");
+  }
+  fflush(out);
+}
+
+
+/**
+ * Posts to many URLs at once for http-post --batch.
+ * @param args Parsed arguments
+ * @param req_headers Request headers, or NULL
+ * @return Exit status: 0 if every request succeeded, 130 if interrupted,
+ *         1 otherwise
+ */
+static int http_post_batch(http_post_args_t *args,
+                           struct curl_slist *req_headers) {
+  const char *post_data = args->data->count > 0 ? args->data->sval[0] : "";
+  size_t count = (size_t)args->url->count;
+  char **lines = NULL;
+  if (count == 0) {
+    lines = read_batch_lines(&count);
+    if (lines == NULL) {
+      fprintf(stderr, "http-post: out of memory\n");
+      return 1;
+    }
+  }
+
+  jbox_http_request_t *requests = calloc(count > 0 ? count : 1,
+                                         sizeof(jbox_http_request_t));
+  if (requests == NULL) {
+    fprintf(stderr, "http-post: out of memory\n");
+  }
+  for (size_t i = 0; requests && i < count; i++) {
+    requests[i].url = lines ? lines[i] : args->url->sval[i];
+    requests[i].post_data = post_data;
+
+    // A tab ends the URL; the rest of the line is its own data
+    char *tab = lines ? strchr(lines[i], '\t') : NULL;
+    if (tab) {
+      *tab = '\0';
+      requests[i].post_data = tab + 1;
+    }
+  }
+
+  jbox_http_batch_opts_t opts = {
+    .headers = req_headers,
+    .user_agent = "jbox-http-post/1.0",
+    .max_parallel = args->jobs->count > 0 ? args->jobs->ival[0] : 0,
+    .in_order = args->ordered->count > 0,
+    .interrupted = jshell_is_interrupted
+  };
+  int failed = requests ? jbox_http_batch(requests, count, &opts,
+                                          print_batch_response, NULL)
+                        : -1;
+
+  free(requests);
+  for (size_t i = 0; lines && i < count; i++) {
+    free(lines[i]);
+  }
+  free(lines);
+
+  if (jshell_is_interrupted()) {
+    return 130;
+  }
+  return failed == 0 ? 0 : 1;
+}
+
+
 /**
  * Main execution function for the http-post command.
  * @param argc Argument count
@@ -259,7 +581,7 @@ static int http_post_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    http_post_print_usage(stdout);
+    http_post_print_usage(jshell_io_stdout());
     cleanup_http_post_argtable(&args);
     return 0;
   }
@@ -271,18 +593,83 @@ static int http_post_run(int argc, char **argv) {
     return 1;
   }
 
+  if (args.data->count > 0 && args.data_file->count > 0) {
+    fprintf(stderr, "http-post: --data and --data-file cannot be combined\n");
+    cleanup_http_post_argtable(&args);
+    return 1;
+  }
+
+  if (args.batch->count > 0) {
+    if (args.data_file->count > 0 || args.gzip->count > 0) {
+      fprintf(stderr, "http-post: --data-file and --gzip cannot be used "
+                      "with --batch\n");
+      cleanup_http_post_argtable(&args);
+      return 1;
+    }
+    struct curl_slist *req_headers = NULL;
+    for (int i = 0; i < args.headers->count; i++) {
+      req_headers = curl_slist_append(req_headers, args.headers->sval[i]);
+    }
+    int ret = http_post_batch(&args, req_headers);
+    curl_slist_free_all(req_headers);
+    cleanup_http_post_argtable(&args);
+    return ret;
+  }
+
+  if (args.url->count != 1) {
+    fprintf(stderr, "http-post: expected one URL (use --batch for several)\n");
+    fprintf(stderr, "Try 'http-post --help' for more information.\n");
+    cleanup_http_post_argtable(&args);
+    return 1;
+  }
+
   const char *url = args.url->sval[0];
   const char *post_data = args.data->count > 0 ? args.data->sval[0] : "";
   int json_output = args.json_output->count > 0;
 
-  CURL *curl = curl_easy_init();
+  /* A body from a file, or one to compress, is streamed to libcurl; a
+   * plain -d body is handed over as it is */
+  request_body_t body = {
+    .data = post_data,
+    .data_len = strlen(post_data),
+    .gzip = args.gzip->count > 0
+  };
+  const char *data_path = args.data_file->count > 0
+                          ? args.data_file->filename[0] : NULL;
+  bool stdin_body = data_path && strcmp(data_path, "-") == 0;
+  if (data_path) {
+    body.in = stdin_body ? jshell_io_stdin() : fopen(data_path, "rb");
+    if (!body.in) {
+      if (json_output) {
+        jshell_printf("{\"status\":\"error\",\"message\":");
+        print_json_string(jshell_io_stdout(), strerror(errno));
+        jshell_printf("}\n");
+      } else {
+        fprintf(stderr, "http-post: %s: %s\n", data_path, strerror(errno));
+      }
+      cleanup_http_post_argtable(&args);
+      return 1;
+    }
+  }
+  if (body.gzip && deflateInit2(&body.zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                                15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    fprintf(stderr, "http-post: failed to initialize compression\n");
+    if (body.in && !stdin_body) fclose(body.in);
+    cleanup_http_post_argtable(&args);
+    return 1;
+  }
+  bool streamed = body.in || body.gzip;
+
+  CURL *curl = jbox_http_acquire();
   if (!curl) {
     if (json_output) {
-      printf("{\"status\":\"error\","
-             "\"message\":\"Failed to initialize curl\"}\n");
+      jshell_printf("{\"status\":\"error\","
+                    "\"message\":\"Failed to initialize curl\"}\n");
     } else {
       fprintf(stderr, "http-post: failed to initialize curl\n");
     }
+    if (body.gzip) deflateEnd(&body.zs);
+    if (body.in && !stdin_body) fclose(body.in);
     cleanup_http_post_argtable(&args);
     return 1;
   }
@@ -293,7 +680,9 @@ static int http_post_run(int argc, char **argv) {
     .capacity = 4096
   };
   if (!response.data) {
-    curl_easy_cleanup(curl);
+    if (body.gzip) deflateEnd(&body.zs);
+    if (body.in && !stdin_body) fclose(body.in);
+    jbox_http_release(curl);
     cleanup_http_post_argtable(&args);
     return 1;
   }
@@ -305,15 +694,35 @@ static int http_post_run(int argc, char **argv) {
     .capacity = 32
   };
   if (!resp_headers.headers) {
+    if (body.gzip) deflateEnd(&body.zs);
+    if (body.in && !stdin_body) fclose(body.in);
     free(response.data);
-    curl_easy_cleanup(curl);
+    jbox_http_release(curl);
     cleanup_http_post_argtable(&args);
     return 1;
   }
 
   curl_easy_setopt(curl, CURLOPT_URL, url);
   curl_easy_setopt(curl, CURLOPT_POST, 1L);
-  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post_data);
+  if (streamed) {
+    curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_callback);
+    curl_easy_setopt(curl, CURLOPT_READDATA, &body);
+    curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, seek_callback);
+    curl_easy_setopt(curl, CURLOPT_SEEKDATA, &body);
+
+    /* A regular file's size is known up front; anything else is sent
+     * with chunked transfer encoding */
+    struct stat st;
+    if (!body.gzip && body.in && fstat(fileno(body.in), &st) == 0
+        && S_ISREG(st.st_mode)) {
+      curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE,
+                       (curl_off_t)(st.st_size - ftello(body.in)));
+    }
+  } else {
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post_data);
+  }
+  /* Accept any encoding libcurl can decode, and decode it on the fly */
+  curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
   curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
   curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
   curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
@@ -331,11 +740,20 @@ static int http_post_run(int argc, char **argv) {
   for (int i = 0; i < args.headers->count; i++) {
     req_headers = curl_slist_append(req_headers, args.headers->sval[i]);
   }
+  if (body.gzip) {
+    req_headers = curl_slist_append(req_headers, "Content-Encoding: gzip");
+  }
   if (req_headers) {
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, req_headers);
   }
 
   CURLcode res = curl_easy_perform(curl);
+  if (body.gzip) {
+    deflateEnd(&body.zs);
+  }
+  if (body.in && !stdin_body) {
+    fclose(body.in);
+  }
 
   long http_code = 0;
   curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
@@ -348,55 +766,56 @@ static int http_post_run(int argc, char **argv) {
   if (res == CURLE_ABORTED_BY_CALLBACK) {
     /* Transfer was interrupted by signal */
     if (json_output) {
-      printf("{\"status\":\"interrupted\",\"message\":\"Transfer interrupted\"}\n");
+      jshell_printf("{\"status\":\"interrupted\","
+                    "\"message\":\"Transfer interrupted\"}\n");
     } else {
       fprintf(stderr, "http-post: transfer interrupted\n");
     }
     ret = 130;  /* 128 + SIGINT(2) */
   } else if (res != CURLE_OK) {
     if (json_output) {
-      printf("{\"status\":\"error\",\"code\":%d,\"message\":", (int)res);
-      print_json_string(stdout, curl_easy_strerror(res));
-      printf("}\n");
+      jshell_printf("{\"status\":\"error\",\"code\":%d,\"message\":", (int)res);
+      print_json_string(jshell_io_stdout(), curl_easy_strerror(res));
+      jshell_printf("}\n");
     } else {
       fprintf(stderr, "http-post: %s\n", curl_easy_strerror(res));
     }
     ret = 1;
   } else {
     if (json_output) {
-      printf("{\"status\":\"ok\",\"http_code\":%ld", http_code);
+      jshell_printf("{\"status\":\"ok\",\"http_code\":%ld", http_code);
 
       if (content_type) {
-        printf(",\"content_type\":");
-        print_json_string(stdout, content_type);
+        jshell_printf(",\"content_type\":");
+        print_json_string(jshell_io_stdout(), content_type);
       }
 
-      printf(",\"headers\":{");
+      jshell_printf(",\"headers\":{");
       int first_header = 1;
       for (size_t i = 1; i < resp_headers.count; i++) {
         char *colon = strchr(resp_headers.headers[i], ':');
         if (colon) {
-          if (!first_header) printf(",");
+          if (!first_header) jshell_printf(",");
           first_header = 0;
 
           *colon = '\0';
           char *value = colon + 1;
           while (*value == ' ') value++;
 
-          print_json_string(stdout, resp_headers.headers[i]);
-          printf(":");
-          print_json_string(stdout, value);
+          print_json_string(jshell_io_stdout(), resp_headers.headers[i]);
+          jshell_printf(":");
+          print_json_string(jshell_io_stdout(), value);
 
           *colon = ':';
         }
       }
-      printf("}");
+      jshell_printf("}");
 
-      printf(",\"body\":");
-      print_json_string(stdout, response.data);
-      printf("}\n");
+      jshell_printf(",\"body\":");
+      print_json_string(jshell_io_stdout(), response.data);
+      jshell_printf("}\n");
     } else {
-      printf("%s", response.data);
+      jshell_printf("%s", response.data);
     }
 
     if (http_code >= 400) {
@@ -409,7 +828,7 @@ static int http_post_run(int argc, char **argv) {
   }
   free_header_buffer(&resp_headers);
   free(response.data);
-  curl_easy_cleanup(curl);
+  jbox_http_release(curl);
   cleanup_http_post_argtable(&args);
 
   return ret;
@@ -423,10 +842,12 @@ const jshell_cmd_spec_t cmd_http_post_spec = {
   .name = "http-post",
   .summary = "send HTTP POST request to a URL",
   .long_help = "Send HTTP POST request to a URL. "
-               "Supports custom headers, request body, and JSON output format.",
+               "Supports custom headers, request body, and JSON output format. "
+               "With --batch, posts to many URLs concurrently.",
   .type = CMD_BUILTIN,
   .run = http_post_run,
-  .print_usage = http_post_print_usage
+  .print_usage = http_post_print_usage,
+  .describe_args = http_post_describe_args
 };
 
 
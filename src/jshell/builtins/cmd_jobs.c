@@ -6,10 +6,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "jshell/jshell_io.h"
 #include "jshell/jshell_job_control.h"
+#include "utils/jbox_json.h"
 
 
 /**
@@ -18,8 +21,9 @@
 typedef struct {
   struct arg_lit *help;
   struct arg_lit *json;
+  struct arg_int *output;
   struct arg_end *end;
-  void *argtable[3];
+  void *argtable[4];
 } jobs_args_t;
 
 
@@ -31,11 +35,14 @@ typedef struct {
 static void build_jobs_argtable(jobs_args_t *args) {
   args->help = arg_lit0("h", "help", "display this help and exit");
   args->json = arg_lit0(NULL, "json", "output in JSON format");
+  args->output = arg_int0(NULL, "output", "ID",
+                          "print the output kept for job ID");
   args->end = arg_end(20);
 
   args->argtable[0] = args->help;
   args->argtable[1] = args->json;
-  args->argtable[2] = args->end;
+  args->argtable[2] = args->output;
+  args->argtable[3] = args->end;
 }
 
 
@@ -60,12 +67,30 @@ static void jobs_print_usage(FILE *out) {
   fprintf(out, "Usage: jobs");
   arg_print_syntax(out, args.argtable, "\n");
   fprintf(out, "List background jobs.\n\n");
+  fprintf(out, "In an interactive session, the output of background jobs\n");
+  fprintf(out, "is kept in memory (the last JSHELL_JOB_OUTPUT bytes, 64K\n");
+  fprintf(out, "by default, 0 to disable) and printed when the job is\n");
+  fprintf(out, "reported done; --output prints it at any time.\n\n");
   fprintf(out, "Options:\n");
   arg_print_glossary(out, args.argtable, "  %-20s %s\n");
   cleanup_jobs_argtable(&args);
 }
 
 
+/**
+ * Passes the jobs argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void jobs_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  jobs_args_t args;
+  build_jobs_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_jobs_argtable(&args);
+}
+
+
 /**
  * Escapes special characters in a string for JSON output.
  *
@@ -134,10 +159,10 @@ static const char* job_status_string(JobStatus status) {
  */
 static void print_job_text(const BackgroundJob *job, void *userdata) {
   (void)userdata;
-  printf("[%d]  %-23s %s\n",
-         job->job_id,
-         job_status_string(job->status),
-         job->cmd_string);
+  jshell_printf("[%d]  %-23s %s\n",
+                job->job_id,
+                job_status_string(job->status),
+                job->cmd_string);
 }
 
 
@@ -151,23 +176,75 @@ static void print_job_json(const BackgroundJob *job, void *userdata) {
   jobs_print_ctx_t *ctx = (jobs_print_ctx_t *)userdata;
 
   if (!ctx->first) {
-    printf(",\n");
+    jshell_printf(",\n");
   }
   ctx->first = 0;
 
   char escaped_cmd[2048];
   escape_json_string(job->cmd_string, escaped_cmd, sizeof(escaped_cmd));
 
-  printf("    {\"id\": %d, \"status\": \"%s\", \"command\": \"%s\", \"pids\": [",
-         job->job_id,
-         job_status_string(job->status),
-         escaped_cmd);
+  jshell_printf("    {\"id\": %d, \"status\": \"%s\", \"command\": \"%s\", "
+                "\"pids\": [",
+                job->job_id,
+                job_status_string(job->status),
+                escaped_cmd);
 
   for (size_t i = 0; i < job->pid_count; i++) {
-    if (i > 0) printf(", ");
-    printf("%d", job->pids[i]);
+    if (i > 0) jshell_printf(", ");
+    jshell_printf("%d", job->pids[i]);
+  }
+  jshell_printf("], ");
+
+  JShellUsage usage;
+  jshell_job_usage(job, &usage);
+  jshell_usage_write_json(jshell_io_stdout(), &usage);
+  if (jshell_sched_is_set(&job->sched)) {
+    jshell_printf(", \"sched\": ");
+    jshell_sched_write_json(jshell_io_stdout(), &job->sched);
   }
-  printf("]}");
+  jshell_printf("}");
+}
+
+
+/**
+ * Prints the output kept for a job, raw or as one JSON object.
+ *
+ * @param job_id Job whose output to print
+ * @param show_json Whether to print JSON
+ * @return 0 on success, 1 if there is no such job or no output was kept
+ */
+static int print_job_output(int job_id, int show_json) {
+  BackgroundJob *job = jshell_find_job_by_id(job_id);
+  if (job == NULL) {
+    fprintf(stderr, "jobs: %d: no such job\n", job_id);
+    return 1;
+  }
+  if (job->spool == NULL) {
+    fprintf(stderr, "jobs: %d: output not kept\n", job_id);
+    return 1;
+  }
+
+  size_t len = 0;
+  uint64_t dropped = 0;
+  bool complete = false;
+  char *data = jshell_spool_read(job->spool, &len, &dropped, &complete);
+  if (data == NULL) {
+    fprintf(stderr, "jobs: out of memory\n");
+    return 1;
+  }
+
+  if (show_json) {
+    jshell_printf("{\"id\": %d, \"status\": \"%s\", \"output\": ",
+                  job->job_id, job_status_string(job->status));
+    jbox_json_write_string_n(jshell_io_stdout(), data, len);
+    jshell_printf(", \"bytes\": %zu, \"dropped\": %" PRIu64
+                  ", \"complete\": %s}\n",
+                  len, dropped, complete ? "true" : "false");
+  } else {
+    fwrite(data, 1, len, jshell_io_stdout());
+  }
+  free(data);
+  return 0;
 }
 
 
@@ -185,7 +262,7 @@ static int jobs_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    jobs_print_usage(stdout);
+    jobs_print_usage(jshell_io_stdout());
     cleanup_jobs_argtable(&args);
     return 0;
   }
@@ -199,11 +276,17 @@ static int jobs_run(int argc, char **argv) {
 
   int show_json = args.json->count > 0;
 
+  if (args.output->count > 0) {
+    int status = print_job_output(args.output->ival[0], show_json);
+    cleanup_jobs_argtable(&args);
+    return status;
+  }
+
   if (show_json) {
     jobs_print_ctx_t ctx = { .show_json = 1, .first = 1 };
-    printf("{\"jobs\": [\n");
+    jshell_printf("{\"jobs\": [\n");
     jshell_for_each_job(print_job_json, &ctx);
-    printf("\n  ]\n}\n");
+    jshell_printf("\n  ]\n}\n");
   } else {
     jshell_for_each_job(print_job_text, NULL);
   }
@@ -220,10 +303,14 @@ const jshell_cmd_spec_t cmd_jobs_spec = {
   .name = "jobs",
   .summary = "list background jobs",
   .long_help = "Display status of jobs in the current shell session.\n"
-               "Shows job number, status, and command for each background job.",
+               "Shows job number, status, and command for each background\n"
+               "job. With --json, also reports elapsed time, CPU time, peak\n"
+               "memory and the placement set with run. --output ID prints\n"
+               "the output kept for a background job.",
   .type = CMD_BUILTIN,
   .run = jobs_run,
-  .print_usage = jobs_print_usage
+  .print_usage = jobs_print_usage,
+  .describe_args = jobs_describe_args
 };
 
 
@@ -12,6 +12,7 @@
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "jshell/jshell_io.h"
 #include "jshell/jshell_job_control.h"
 
 
@@ -85,6 +86,20 @@ static void kill_print_usage(FILE *out) {
 }
 
 
+/**
+ * Passes the kill argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void kill_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  kill_args_t args;
+  build_kill_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_kill_argtable(&args);
+}
+
+
 /**
  * Signal name to number mapping entry
  */
@@ -183,13 +198,13 @@ static const char* signal_name(int signum) {
  */
 static void print_json_result(pid_t pid, int signum, const char *status,
                               const char *message) {
-  printf("{\"pid\": %d, \"signal\": %d, \"signal_name\": \"%s\", "
-         "\"status\": \"%s\"",
-         pid, signum, signal_name(signum), status);
+  jshell_printf("{\"pid\": %d, \"signal\": %d, \"signal_name\": \"%s\", "
+                "\"status\": \"%s\"",
+                pid, signum, signal_name(signum), status);
   if (message) {
-    printf(", \"message\": \"%s\"", message);
+    jshell_printf(", \"message\": \"%s\"", message);
   }
-  printf("}\n");
+  jshell_printf("}\n");
 }
 
 
@@ -207,7 +222,7 @@ static int kill_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    kill_print_usage(stdout);
+    kill_print_usage(jshell_io_stdout());
     cleanup_kill_argtable(&args);
     return 0;
   }
@@ -226,8 +241,9 @@ static int kill_run(int argc, char **argv) {
   int signum = parse_signal(sig_str);
   if (signum < 0) {
     if (show_json) {
-      printf("{\"status\": \"error\", \"message\": \"invalid signal: %s\"}\n",
-             sig_str);
+      jshell_printf("{\"status\": \"error\", "
+                    "\"message\": \"invalid signal: %s\"}\n",
+                    sig_str);
     } else {
       fprintf(stderr, "kill: invalid signal: %s\n", sig_str);
     }
@@ -242,8 +258,9 @@ static int kill_run(int argc, char **argv) {
     long job_id = strtol(pid_str + 1, &endptr, 10);
     if (*endptr != '\0' || job_id <= 0) {
       if (show_json) {
-        printf("{\"status\": \"error\", "
-               "\"message\": \"invalid job specification: %s\"}\n", pid_str);
+        jshell_printf("{\"status\": \"error\", "
+                      "\"message\": \"invalid job specification: %s\"}\n",
+                      pid_str);
       } else {
         fprintf(stderr, "kill: invalid job specification: %s\n", pid_str);
       }
@@ -254,8 +271,9 @@ static int kill_run(int argc, char **argv) {
     BackgroundJob *job = jshell_find_job_by_id((int)job_id);
     if (job == NULL) {
       if (show_json) {
-        printf("{\"status\": \"error\", \"message\": \"no such job: %ld\"}\n",
-               job_id);
+        jshell_printf("{\"status\": \"error\", "
+                      "\"message\": \"no such job: %ld\"}\n",
+                      job_id);
       } else {
         fprintf(stderr, "kill: no such job: %ld\n", job_id);
       }
@@ -263,11 +281,21 @@ static int kill_run(int argc, char **argv) {
       return 1;
     }
 
+    /* A thread job has no process to signal; ask its thread to stop */
+    if (job->pid_count == 0) {
+      atomic_store(&job->cancelled, true);
+      if (show_json) {
+        jshell_printf("{\"status\": \"ok\", \"job\": %d}\n", job->job_id);
+      }
+      cleanup_kill_argtable(&args);
+      return 0;
+    }
+
     int success_count = 0;
     int error_count = 0;
 
     if (show_json) {
-      printf("{\"results\": [\n");
+      jshell_printf("{\"results\": [\n");
     }
 
     for (size_t i = 0; i < job->pid_count; i++) {
@@ -276,13 +304,13 @@ static int kill_run(int argc, char **argv) {
       if (result == 0) {
         success_count++;
         if (show_json) {
-          if (i > 0) printf(",\n");
+          if (i > 0) jshell_printf(",\n");
           print_json_result(pid, signum, "ok", NULL);
         }
       } else {
         error_count++;
         if (show_json) {
-          if (i > 0) printf(",\n");
+          if (i > 0) jshell_printf(",\n");
           print_json_result(pid, signum, "error", strerror(errno));
         } else {
           fprintf(stderr, "kill: (%d) - %s\n", pid, strerror(errno));
@@ -291,7 +319,7 @@ static int kill_run(int argc, char **argv) {
     }
 
     if (show_json) {
-      printf("]}\n");
+      jshell_printf("]}\n");
     }
 
     cleanup_kill_argtable(&args);
@@ -302,8 +330,8 @@ static int kill_run(int argc, char **argv) {
   long pid_val = strtol(pid_str, &endptr, 10);
   if (*endptr != '\0') {
     if (show_json) {
-      printf("{\"status\": \"error\", "
-             "\"message\": \"invalid process ID: %s\"}\n", pid_str);
+      jshell_printf("{\"status\": \"error\", "
+                    "\"message\": \"invalid process ID: %s\"}\n", pid_str);
     } else {
       fprintf(stderr, "kill: invalid process ID: %s\n", pid_str);
     }
@@ -342,7 +370,8 @@ const jshell_cmd_spec_t cmd_kill_spec = {
                "Default signal is TERM (15).",
   .type = CMD_BUILTIN,
   .run = kill_run,
-  .print_usage = kill_print_usage
+  .print_usage = kill_print_usage,
+  .describe_args = kill_describe_args
 };
 
 
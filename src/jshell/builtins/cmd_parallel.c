@@ -0,0 +1,794 @@
+/**
+ * @file cmd_parallel.c
+ * @brief Implementation of the parallel builtin for running a command over
+ *        many inputs with bounded concurrency
+ *
+ * Each input becomes one task: the command template with every "{}"
+ * replaced by the input (or the input appended if the template has no
+ * "{}"). Up to --jobs tasks run at once. Builtins run on worker threads
+ * with private streams, everything else is spawned as a child process.
+ * Task output is captured through a pipe per task and printed in input
+ * order, so the result reads as if the commands had run one after another.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "argtable3.h"
+#include "jshell/jshell_cmd_registry.h"
+#include "jshell/jshell_io.h"
+#include "jshell/jshell_path.h"
+#include "jshell/jshell_register_externals.h"
+#include "jshell/jshell_signals.h"
+#include "jshell/jshell_spawn.h"
+#include "jshell/jshell_thread_exec.h"
+#include "utils/jbox_json.h"
+
+
+// Upper bound on --jobs; each running task holds a pipe and a thread/child
+#define PARALLEL_MAX_JOBS 256
+
+// Separator between the command template and its inputs
+#define PARALLEL_INPUT_SEPARATOR ":::"
+
+// Placeholder replaced by the task's input
+#define PARALLEL_PLACEHOLDER "{}"
+
+// Largest exit status reported for failed tasks (same as GNU parallel)
+#define PARALLEL_MAX_FAILED_STATUS 101
+
+
+/**
+ * Argument table structure for the parallel command
+ */
+typedef struct {
+  struct arg_lit *help;
+  struct arg_lit *json;
+  struct arg_int *jobs;
+  struct arg_str *command;
+  struct arg_end *end;
+  void *argtable[5];
+} parallel_args_t;
+
+
+/**
+ * State of one task (one input)
+ */
+typedef struct {
+  const char *input;
+  pid_t pid;                    // Child process, or -1
+  JShellBuiltinThread *thread;  // Worker thread for builtins, or NULL
+  int output_fd;                // Read end of the capture pipe, or -1
+  char *output;
+  size_t output_len;
+  size_t output_cap;
+  int exit_status;
+  bool finished;
+} parallel_task_t;
+
+
+/**
+ * Builds the argtable3 argument table for the parallel command.
+ *
+ * @param args Pointer to parallel_args_t structure to populate
+ */
+static void build_parallel_argtable(parallel_args_t *args) {
+  args->help = arg_lit0("h", "help", "display this help and exit");
+  args->json = arg_lit0(NULL, "json", "output in JSON format");
+  args->jobs = arg_int0("j", "jobs", "N",
+                        "run at most N commands at once "
+                        "(default: number of CPUs)");
+  args->command = arg_strn(NULL, NULL, "COMMAND", 0, 1,
+                           "command template, then ::: INPUT...");
+  args->end = arg_end(20);
+
+  args->argtable[0] = args->help;
+  args->argtable[1] = args->json;
+  args->argtable[2] = args->jobs;
+  args->argtable[3] = args->command;
+  args->argtable[4] = args->end;
+}
+
+
+/**
+ * Cleans up the argtable3 argument table for the parallel command.
+ *
+ * @param args Pointer to parallel_args_t structure to free
+ */
+static void cleanup_parallel_argtable(parallel_args_t *args) {
+  arg_freetable(args->argtable,
+                sizeof(args->argtable) / sizeof(args->argtable[0]));
+}
+
+
+/**
+ * Prints usage information for the parallel command.
+ *
+ * @param out Output stream to write to
+ */
+static void parallel_print_usage(FILE *out) {
+  parallel_args_t args;
+  build_parallel_argtable(&args);
+  fprintf(out, "Usage: parallel [-h] [--json] [-j N] COMMAND [ARG...] "
+               "[::: INPUT...]\n");
+  fprintf(out, "Run COMMAND once per INPUT, several at a time.\n\n");
+  fprintf(out, "Every {} in the command is replaced by the input; if there\n");
+  fprintf(out, "is no {}, the input is appended as the last argument.\n");
+  fprintf(out, "Without ::: inputs are read from standard input, one per "
+               "line.\n");
+  fprintf(out, "Output of each command is printed in input order.\n");
+  fprintf(out, "Exit status is the number of failed commands (at most "
+               "%d).\n\n", PARALLEL_MAX_FAILED_STATUS);
+  fprintf(out, "Options:\n");
+  arg_print_glossary(out, args.argtable, "  %-20s %s\n");
+  cleanup_parallel_argtable(&args);
+}
+
+
+/**
+ * Passes the parallel argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void parallel_describe_args(jshell_argtable_visit_fn visit,
+                                   void *userdata) {
+  parallel_args_t args;
+  build_parallel_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_parallel_argtable(&args);
+}
+
+
+/**
+ * Finds where the options end and the command template begins.
+ *
+ * Options are only recognised before the command, so the command's own
+ * flags (e.g. "rg -n") are passed through untouched.
+ *
+ * @param argc Argument count
+ * @param argv Argument vector
+ * @param skip_separator Set to true if the command is preceded by "--"
+ * @return Index of the first option-free argument
+ */
+static int find_command_start(int argc, char **argv, bool *skip_separator) {
+  *skip_separator = false;
+
+  int i = 1;
+  while (i < argc) {
+    const char *arg = argv[i];
+    if (strcmp(arg, "--") == 0) {
+      *skip_separator = true;
+      return i;
+    }
+    if (arg[0] != '-' || arg[1] == '\0') {
+      return i;
+    }
+    if (strcmp(arg, "-j") == 0 || strcmp(arg, "--jobs") == 0) {
+      i += 2;
+    } else {
+      i++;
+    }
+  }
+
+  return argc < i ? argc : i;
+}
+
+
+/**
+ * Reads task inputs from the current input stream, one per line.
+ *
+ * @param count Set to the number of inputs read
+ * @return Allocated array of allocated lines, or NULL on error
+ */
+static char **read_stdin_inputs(size_t *count) {
+  size_t cap = 16;
+  size_t n = 0;
+  char **inputs = malloc(cap * sizeof(char *));
+  if (inputs == NULL) {
+    perror("parallel: malloc");
+    return NULL;
+  }
+
+  char *line = NULL;
+  size_t line_cap = 0;
+  ssize_t len;
+  FILE *in = jshell_io_stdin();
+
+  while ((len = getline(&line, &line_cap, in)) != -1) {
+    if (len > 0 && line[len - 1] == '\n') {
+      line[--len] = '\0';
+    }
+    if (n == cap) {
+      cap *= 2;
+      char **grown = realloc(inputs, cap * sizeof(char *));
+      if (grown == NULL) {
+        perror("parallel: realloc");
+        break;
+      }
+      inputs = grown;
+    }
+    inputs[n] = strdup(line);
+    if (inputs[n] == NULL) {
+      perror("parallel: strdup");
+      break;
+    }
+    n++;
+  }
+
+  free(line);
+  *count = n;
+  return inputs;
+}
+
+
+/**
+ * Substitutes an input into one template word.
+ *
+ * @param word Template word
+ * @param input Task input
+ * @return Allocated word with every placeholder replaced, or NULL
+ */
+static char *substitute_word(const char *word, const char *input) {
+  size_t placeholder_len = strlen(PARALLEL_PLACEHOLDER);
+  size_t input_len = strlen(input);
+  size_t count = 0;
+
+  for (const char *p = strstr(word, PARALLEL_PLACEHOLDER); p != NULL;
+       p = strstr(p + placeholder_len, PARALLEL_PLACEHOLDER)) {
+    count++;
+  }
+
+  size_t len = strlen(word) + count * input_len - count * placeholder_len;
+  char *result = malloc(len + 1);
+  if (result == NULL) {
+    return NULL;
+  }
+
+  char *dst = result;
+  const char *src = word;
+  const char *p;
+  while ((p = strstr(src, PARALLEL_PLACEHOLDER)) != NULL) {
+    memcpy(dst, src, (size_t)(p - src));
+    dst += p - src;
+    memcpy(dst, input, input_len);
+    dst += input_len;
+    src = p + placeholder_len;
+  }
+  strcpy(dst, src);
+
+  return result;
+}
+
+
+/**
+ * Frees an argument vector built by build_task_argv.
+ *
+ * @param argv NULL-terminated argument vector
+ */
+static void free_task_argv(char **argv) {
+  if (argv == NULL) {
+    return;
+  }
+  for (size_t i = 0; argv[i] != NULL; i++) {
+    free(argv[i]);
+  }
+  free(argv);
+}
+
+
+/**
+ * Builds the argument vector of one task from the command template.
+ *
+ * @param template Command template words
+ * @param template_count Number of template words
+ * @param append_input true if the template has no placeholder
+ * @param input Task input
+ * @param argc_out Set to the argument count
+ * @return Allocated NULL-terminated argument vector, or NULL on error
+ */
+static char **build_task_argv(char **template, int template_count,
+                              bool append_input, const char *input,
+                              int *argc_out) {
+  int argc = template_count + (append_input ? 1 : 0);
+  char **argv = calloc((size_t)argc + 1, sizeof(char *));
+  if (argv == NULL) {
+    return NULL;
+  }
+
+  for (int i = 0; i < template_count; i++) {
+    argv[i] = append_input ? strdup(template[i])
+                           : substitute_word(template[i], input);
+    if (argv[i] == NULL) {
+      free_task_argv(argv);
+      return NULL;
+    }
+  }
+  if (append_input) {
+    argv[template_count] = strdup(input);
+    if (argv[template_count] == NULL) {
+      free_task_argv(argv);
+      return NULL;
+    }
+  }
+
+  *argc_out = argc;
+  return argv;
+}
+
+
+/**
+ * Starts one task with its output going to a fresh capture pipe.
+ *
+ * Tasks read from /dev/null so they do not compete for the shell's input.
+ * The pipes are close-on-exec, so a child spawned for one task never holds
+ * another task's write end open and every task sees EOF on time.
+ * A task that cannot be started is marked finished with its status.
+ *
+ * @param task Task to start
+ * @param argc Argument count of the task's command
+ * @param argv Argument vector of the task's command
+ */
+static void start_task(parallel_task_t *task, int argc, char **argv) {
+  const jshell_cmd_spec_t *spec = jshell_find_command(argv[0]);
+
+  if (spec != NULL && spec->type == CMD_EXTERNAL
+      && !jshell_is_linked_command(spec)) {
+    fprintf(stderr, "parallel: %s cannot run in parallel\n", argv[0]);
+    task->exit_status = 1;
+    task->finished = true;
+    return;
+  }
+  if (spec != NULL && spec->type == CMD_BUILTIN
+      && !jshell_builtin_is_pipeline_safe(spec->name)) {
+    fprintf(stderr, "parallel: %s changes shell state and cannot run in "
+                    "parallel\n", argv[0]);
+    task->exit_status = 1;
+    task->finished = true;
+    return;
+  }
+
+  int pipe_fds[2];
+  if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+    perror("parallel: pipe");
+    task->exit_status = 1;
+    task->finished = true;
+    return;
+  }
+
+  int input_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  if (input_fd == -1) {
+    perror("parallel: /dev/null");
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    task->exit_status = 1;
+    task->finished = true;
+    return;
+  }
+
+  /* Linked apps run under their own jbox_ctx_t, so they thread too */
+  if (spec != NULL
+      && (spec->type == CMD_BUILTIN || jshell_is_linked_command(spec))) {
+    task->thread = jshell_spawn_builtin_thread(spec, argc, argv,
+                                               input_fd, pipe_fds[1]);
+    if (task->thread == NULL) {
+      close(input_fd);
+      close(pipe_fds[0]);
+      close(pipe_fds[1]);
+      task->exit_status = 1;
+      task->finished = true;
+      return;
+    }
+    task->output_fd = pipe_fds[0];
+    return;
+  }
+
+  char *exec_path;
+  if (spec != NULL && spec->type == CMD_PACKAGE && spec->bin_path != NULL) {
+    exec_path = strdup(spec->bin_path);
+  } else {
+    exec_path = jshell_resolve_command(argv[0]);
+  }
+
+  int failure_status = 0;
+  task->pid = jshell_spawn_command(exec_path, argv, input_fd, pipe_fds[1],
+                                   NULL, 0, &failure_status);
+  free(exec_path);
+  close(input_fd);
+  close(pipe_fds[1]);
+
+  if (task->pid == -1) {
+    close(pipe_fds[0]);
+    task->exit_status = failure_status;
+    task->finished = true;
+    return;
+  }
+  task->output_fd = pipe_fds[0];
+}
+
+
+/**
+ * Collects the exit status of a task whose output reached EOF.
+ *
+ * @param task Task to finish
+ */
+static void finish_task(parallel_task_t *task) {
+  if (task->thread != NULL) {
+    task->exit_status = jshell_wait_builtin_thread(task->thread);
+    jshell_free_builtin_thread(task->thread);
+    task->thread = NULL;
+  } else if (task->pid > 0) {
+    int status;
+    pid_t rc;
+    do {
+      rc = waitpid(task->pid, &status, 0);
+    } while (rc == -1 && errno == EINTR);
+
+    if (rc == -1) {
+      perror("parallel: waitpid");
+      task->exit_status = 1;
+    } else if (WIFEXITED(status)) {
+      task->exit_status = WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+      task->exit_status = 128 + WTERMSIG(status);
+    }
+    task->pid = -1;
+  }
+  task->finished = true;
+}
+
+
+/**
+ * Reads available output of a task into its buffer.
+ *
+ * @param task Task with a readable capture pipe
+ * @return true once the pipe has reached EOF (and has been closed)
+ */
+static bool drain_task_output(parallel_task_t *task) {
+  if (task->output_cap - task->output_len < 4096) {
+    size_t cap = task->output_cap == 0 ? 8192 : task->output_cap * 2;
+    char *grown = realloc(task->output, cap);
+    if (grown == NULL) {
+      perror("parallel: realloc");
+      close(task->output_fd);
+      task->output_fd = -1;
+      return true;
+    }
+    task->output = grown;
+    task->output_cap = cap;
+  }
+
+  ssize_t n = read(task->output_fd, task->output + task->output_len,
+                   task->output_cap - task->output_len);
+  if (n > 0) {
+    task->output_len += (size_t)n;
+    return false;
+  }
+  if (n == -1 && (errno == EINTR || errno == EAGAIN)) {
+    return false;
+  }
+
+  close(task->output_fd);
+  task->output_fd = -1;
+  return true;
+}
+
+
+/**
+ * Prints a finished task's result and releases its output buffer.
+ *
+ * @param task Finished task
+ * @param show_json true for JSON output
+ * @param first true if this is the first task printed
+ */
+static void emit_task(parallel_task_t *task, bool show_json, bool first) {
+  FILE *out = jshell_io_stdout();
+
+  if (show_json) {
+    fprintf(out, "%s\n    {\"input\": ", first ? "" : ",");
+    jbox_json_write_string(out, task->input);
+    fprintf(out, ", \"exit_status\": %d, \"output\": ", task->exit_status);
+    jbox_json_write_string_n(out, task->output, task->output_len);
+    fputc('}', out);
+  } else if (task->output_len > 0) {
+    fwrite(task->output, 1, task->output_len, out);
+  }
+
+  free(task->output);
+  task->output = NULL;
+  task->output_len = 0;
+  task->output_cap = 0;
+}
+
+
+/**
+ * Runs every task with at most max_jobs in flight, printing in order.
+ *
+ * Stops launching new tasks on SIGINT but still collects running ones.
+ *
+ * @param tasks Tasks, one per input
+ * @param task_count Number of tasks
+ * @param template Command template words
+ * @param template_count Number of template words
+ * @param max_jobs Concurrency limit
+ * @param show_json true for JSON output
+ * @param interrupted Set to true if SIGINT stopped the run early
+ * @return Number of tasks that exited non-zero
+ */
+static size_t run_tasks(parallel_task_t *tasks, size_t task_count,
+                        char **template, int template_count,
+                        int max_jobs, bool show_json, bool *interrupted) {
+  bool append_input = true;
+  for (int i = 0; i < template_count; i++) {
+    if (strstr(template[i], PARALLEL_PLACEHOLDER) != NULL) {
+      append_input = false;
+      break;
+    }
+  }
+
+  struct pollfd *pfds = malloc((size_t)max_jobs * sizeof(struct pollfd));
+  size_t *pfd_tasks = malloc((size_t)max_jobs * sizeof(size_t));
+  if (pfds == NULL || pfd_tasks == NULL) {
+    perror("parallel: malloc");
+    free(pfds);
+    free(pfd_tasks);
+    *interrupted = true;
+    return 0;
+  }
+
+  size_t launched = 0;
+  size_t emitted = 0;
+  size_t failed = 0;
+  int running = 0;
+
+  /* A background job is stopped by `kill`, which only sets a flag, so
+   * look at it every so often and stop the workers ourselves */
+  bool background = jshell_get_thread_cancel_flag() != NULL;
+
+  while (emitted < task_count) {
+    if (jshell_is_interrupted()) {
+      *interrupted = true;
+      if (background) {
+        break;
+      }
+    }
+
+    while (!*interrupted && running < max_jobs && launched < task_count) {
+      parallel_task_t *task = &tasks[launched++];
+      int argc = 0;
+      char **argv = build_task_argv(template, template_count, append_input,
+                                    task->input, &argc);
+      if (argv == NULL) {
+        perror("parallel: malloc");
+        task->exit_status = 1;
+        task->finished = true;
+        continue;
+      }
+      start_task(task, argc, argv);
+      free_task_argv(argv);
+      if (!task->finished) {
+        running++;
+      }
+    }
+
+    while (emitted < launched && tasks[emitted].finished) {
+      if (tasks[emitted].exit_status != 0) {
+        failed++;
+      }
+      emit_task(&tasks[emitted], show_json, emitted == 0);
+      emitted++;
+    }
+
+    if (running == 0) {
+      if (*interrupted || emitted == task_count) {
+        break;
+      }
+      continue;
+    }
+
+    nfds_t nfds = 0;
+    for (size_t i = emitted; i < launched; i++) {
+      if (tasks[i].output_fd != -1) {
+        pfds[nfds].fd = tasks[i].output_fd;
+        pfds[nfds].events = POLLIN;
+        pfds[nfds].revents = 0;
+        pfd_tasks[nfds] = i;
+        nfds++;
+      }
+    }
+
+    if (poll(pfds, nfds, background ? 100 : -1) == -1) {
+      if (errno != EINTR) {
+        perror("parallel: poll");
+        break;
+      }
+      continue;
+    }
+
+    for (nfds_t i = 0; i < nfds; i++) {
+      if (pfds[i].revents == 0) {
+        continue;
+      }
+      parallel_task_t *task = &tasks[pfd_tasks[i]];
+      if (drain_task_output(task)) {
+        finish_task(task);
+        running--;
+      }
+    }
+  }
+
+  // Only reached early on a poll failure or a killed background job;
+  // don't leave workers behind
+  for (size_t i = emitted; i < launched; i++) {
+    if (tasks[i].output_fd != -1) {
+      close(tasks[i].output_fd);
+      tasks[i].output_fd = -1;
+    }
+    if (tasks[i].pid > 0) {
+      kill(tasks[i].pid, SIGTERM);
+    }
+    if (!tasks[i].finished) {
+      finish_task(&tasks[i]);
+    }
+    free(tasks[i].output);
+  }
+
+  free(pfds);
+  free(pfd_tasks);
+  return failed;
+}
+
+
+/**
+ * Executes the parallel command.
+ *
+ * @param argc Argument count
+ * @param argv Argument vector
+ * @return Number of failed commands (capped), 130 if interrupted, or 1 on
+ *         usage errors
+ */
+static int parallel_run(int argc, char **argv) {
+  bool skip_separator;
+  int command_start = find_command_start(argc, argv, &skip_separator);
+
+  parallel_args_t args;
+  build_parallel_argtable(&args);
+
+  int nerrors = arg_parse(command_start, argv, args.argtable);
+
+  if (args.help->count > 0) {
+    parallel_print_usage(jshell_io_stdout());
+    cleanup_parallel_argtable(&args);
+    return 0;
+  }
+
+  if (nerrors > 0) {
+    arg_print_errors(stderr, args.end, "parallel");
+    fprintf(stderr, "Try 'parallel --help' for more information.\n");
+    cleanup_parallel_argtable(&args);
+    return 1;
+  }
+
+  bool show_json = args.json->count > 0;
+
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int max_jobs = cpus > 0 ? (int)cpus : 1;
+  if (args.jobs->count > 0) {
+    max_jobs = args.jobs->ival[0];
+  }
+  cleanup_parallel_argtable(&args);
+
+  if (max_jobs < 1) {
+    fprintf(stderr, "parallel: --jobs must be at least 1\n");
+    return 1;
+  }
+  if (max_jobs > PARALLEL_MAX_JOBS) {
+    max_jobs = PARALLEL_MAX_JOBS;
+  }
+
+  if (skip_separator) {
+    command_start++;
+  }
+
+  int separator = command_start;
+  while (separator < argc
+         && strcmp(argv[separator], PARALLEL_INPUT_SEPARATOR) != 0) {
+    separator++;
+  }
+
+  char **template = &argv[command_start];
+  int template_count = separator - command_start;
+  if (template_count == 0) {
+    fprintf(stderr, "parallel: missing command\n");
+    fprintf(stderr, "Try 'parallel --help' for more information.\n");
+    return 1;
+  }
+
+  char **stdin_inputs = NULL;
+  size_t input_count;
+  if (separator < argc) {
+    input_count = (size_t)(argc - separator - 1);
+  } else {
+    stdin_inputs = read_stdin_inputs(&input_count);
+    if (stdin_inputs == NULL) {
+      return 1;
+    }
+  }
+
+  parallel_task_t *tasks = calloc(input_count > 0 ? input_count : 1,
+                                  sizeof(parallel_task_t));
+  if (tasks == NULL) {
+    perror("parallel: calloc");
+    for (size_t i = 0; stdin_inputs != NULL && i < input_count; i++) {
+      free(stdin_inputs[i]);
+    }
+    free(stdin_inputs);
+    return 1;
+  }
+
+  for (size_t i = 0; i < input_count; i++) {
+    tasks[i].input = stdin_inputs != NULL ? stdin_inputs[i]
+                                          : argv[separator + 1 + (int)i];
+    tasks[i].pid = -1;
+    tasks[i].output_fd = -1;
+  }
+
+  if (show_json) {
+    jshell_printf("{\"tasks\": [");
+  }
+
+  bool interrupted = false;
+  size_t failed = run_tasks(tasks, input_count, template, template_count,
+                            max_jobs, show_json, &interrupted);
+
+  if (show_json) {
+    jshell_printf("%s],\n  \"failed\": %zu\n}\n",
+                  input_count > 0 ? "\n  " : "", failed);
+  }
+
+  free(tasks);
+  for (size_t i = 0; stdin_inputs != NULL && i < input_count; i++) {
+    free(stdin_inputs[i]);
+  }
+  free(stdin_inputs);
+
+  if (interrupted) {
+    return 130;  /* 128 + SIGINT(2) */
+  }
+  return failed > PARALLEL_MAX_FAILED_STATUS ? PARALLEL_MAX_FAILED_STATUS
+                                             : (int)failed;
+}
+
+
+/**
+ * Command specification for the parallel builtin
+ */
+const jshell_cmd_spec_t cmd_parallel_spec = {
+  .name = "parallel",
+  .summary = "run a command over many inputs concurrently",
+  .long_help = "Run COMMAND once per INPUT with at most N instances at once.\n"
+               "Each {} in COMMAND is replaced by the input. Output is\n"
+               "printed in input order.",
+  .type = CMD_BUILTIN,
+  .run = parallel_run,
+  .print_usage = parallel_print_usage,
+  .describe_args = parallel_describe_args
+};
+
+
+/**
+ * Registers the parallel command with the shell command registry.
+ */
+void jshell_register_parallel_command(void) {
+  jshell_register_command(&cmd_parallel_spec);
+}
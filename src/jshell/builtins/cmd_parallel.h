@@ -0,0 +1,12 @@
+#ifndef CMD_PARALLEL_H
+#define CMD_PARALLEL_H
+
+#include "jshell/jshell_cmd_registry.h"
+
+
+extern const jshell_cmd_spec_t cmd_parallel_spec;
+
+void jshell_register_parallel_command(void);
+
+
+#endif
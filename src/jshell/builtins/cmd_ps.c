@@ -9,6 +9,7 @@
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "jshell/jshell_io.h"
 #include "jshell/jshell_job_control.h"
 
 
@@ -67,6 +68,20 @@ static void ps_print_usage(FILE *out) {
 }
 
 
+/**
+ * Passes the ps argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void ps_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  ps_args_t args;
+  build_ps_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_ps_argtable(&args);
+}
+
+
 /**
  * Escapes special characters in a string for JSON output.
  *
@@ -136,11 +151,11 @@ typedef struct {
 static void print_process_text(const BackgroundJob *job, void *userdata) {
   (void)userdata;
   for (size_t i = 0; i < job->pid_count; i++) {
-    printf("%6d  [%d]  %-10s  %s\n",
-           job->pids[i],
-           job->job_id,
-           job_status_string(job->status),
-           job->cmd_string);
+    jshell_printf("%6d  [%d]  %-10s  %s\n",
+                  job->pids[i],
+                  job->job_id,
+                  job_status_string(job->status),
+                  job->cmd_string);
   }
 }
 
@@ -159,16 +174,23 @@ static void print_process_json(const BackgroundJob *job, void *userdata) {
 
   for (size_t i = 0; i < job->pid_count; i++) {
     if (!ctx->first_proc) {
-      printf(",\n");
+      jshell_printf(",\n");
     }
     ctx->first_proc = 0;
 
-    printf("    {\"pid\": %d, \"job_id\": %d, \"status\": \"%s\", "
-           "\"command\": \"%s\"}",
-           job->pids[i],
-           job->job_id,
-           job_status_string(job->status),
-           escaped_cmd);
+    jshell_printf("    {\"pid\": %d, \"job_id\": %d, \"status\": \"%s\", "
+                  "\"command\": \"%s\"",
+                  job->pids[i],
+                  job->job_id,
+                  job_status_string(job->status),
+                  escaped_cmd);
+
+    JShellUsage usage;
+    if (jshell_job_pid_usage(job, i, &usage)) {
+      jshell_printf(", ");
+      jshell_usage_write_json(jshell_io_stdout(), &usage);
+    }
+    jshell_printf("}");
   }
 }
 
@@ -187,7 +209,7 @@ static int ps_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    ps_print_usage(stdout);
+    ps_print_usage(jshell_io_stdout());
     cleanup_ps_argtable(&args);
     return 0;
   }
@@ -203,11 +225,11 @@ static int ps_run(int argc, char **argv) {
 
   if (show_json) {
     ps_print_ctx_t ctx = { .show_json = 1, .first_proc = 1 };
-    printf("{\"processes\": [\n");
+    jshell_printf("{\"processes\": [\n");
     jshell_for_each_job(print_process_json, &ctx);
-    printf("\n  ]\n}\n");
+    jshell_printf("\n  ]\n}\n");
   } else {
-    printf("   PID  JOB   STATUS      COMMAND\n");
+    jshell_printf("   PID  JOB   STATUS      COMMAND\n");
     jshell_for_each_job(print_process_text, NULL);
   }
 
@@ -223,10 +245,12 @@ const jshell_cmd_spec_t cmd_ps_spec = {
   .name = "ps",
   .summary = "list processes known to the shell",
   .long_help = "Display a list of processes associated with background jobs\n"
-               "in the current shell session.",
+               "in the current shell session. With --json, also reports the\n"
+               "elapsed time, CPU time and peak memory of each process.",
   .type = CMD_BUILTIN,
   .run = ps_run,
-  .print_usage = ps_print_usage
+  .print_usage = ps_print_usage,
+  .describe_args = ps_describe_args
 };
 
 
@@ -12,6 +12,8 @@
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "jshell/jshell_cwd.h"
+#include "jshell/jshell_io.h"
 
 
 /**
@@ -69,6 +71,20 @@ static void pwd_print_usage(FILE *out) {
 }
 
 
+/**
+ * Passes the pwd argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void pwd_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  pwd_args_t args;
+  build_pwd_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_pwd_argtable(&args);
+}
+
+
 /**
  * Escapes special characters in a string for JSON output.
  *
@@ -118,7 +134,7 @@ static int pwd_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    pwd_print_usage(stdout);
+    pwd_print_usage(jshell_io_stdout());
     cleanup_pwd_argtable(&args);
     return 0;
   }
@@ -133,9 +149,10 @@ static int pwd_run(int argc, char **argv) {
   int show_json = args.json->count > 0;
   char cwd[PATH_MAX];
 
-  if (getcwd(cwd, sizeof(cwd)) == NULL) {
+  if (jshell_cwd_path(cwd, sizeof(cwd)) == NULL) {
     if (show_json) {
-      printf("{\"status\": \"error\", \"message\": \"%s\"}\n", strerror(errno));
+      jshell_printf("{\"status\": \"error\", "
+                    "\"message\": \"%s\"}\n", strerror(errno));
     } else {
       fprintf(stderr, "pwd: error getting current directory: %s\n",
               strerror(errno));
@@ -147,9 +164,9 @@ static int pwd_run(int argc, char **argv) {
   if (show_json) {
     char escaped_cwd[PATH_MAX * 2];
     escape_json_string(cwd, escaped_cwd, sizeof(escaped_cwd));
-    printf("{\"cwd\": \"%s\"}\n", escaped_cwd);
+    jshell_printf("{\"cwd\": \"%s\"}\n", escaped_cwd);
   } else {
-    printf("%s\n", cwd);
+    jshell_printf("%s\n", cwd);
   }
 
   cleanup_pwd_argtable(&args);
@@ -166,7 +183,8 @@ const jshell_cmd_spec_t cmd_pwd_spec = {
   .long_help = "Print the full filename of the current working directory.",
   .type = CMD_BUILTIN,
   .run = pwd_run,
-  .print_usage = pwd_print_usage
+  .print_usage = pwd_print_usage,
+  .describe_args = pwd_describe_args
 };
 
 
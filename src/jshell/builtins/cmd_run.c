@@ -0,0 +1,160 @@
+/**
+ * @file cmd_run.c
+ * @brief Help for the run prefix, which the interpreter handles
+ *
+ * `run [--cpus LIST] [--nice N] [--cgroup PATH] command ...` is stripped
+ * from a job before it runs and the job's processes are placed
+ * accordingly (see jshell_sched.h). This builtin is only reached without
+ * a command or with an option the prefix does not take, e.g. for
+ * `run --help`.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "argtable3.h"
+#include "jshell/jshell_cmd_registry.h"
+#include "jshell/jshell_io.h"
+
+
+/**
+ * Arguments structure for the run command.
+ */
+typedef struct {
+  struct arg_lit *help;
+  struct arg_str *cpus;
+  struct arg_int *nice;
+  struct arg_str *cgroup;
+  struct arg_str *command;
+  struct arg_end *end;
+  void *argtable[6];
+} run_args_t;
+
+
+/**
+ * Builds the argtable3 structure for the run command.
+ *
+ * @param args Pointer to run_args_t structure to populate
+ */
+static void build_run_argtable(run_args_t *args) {
+  args->help    = arg_lit0("h", "help", "display this help and exit");
+  args->cpus    = arg_str0(NULL, "cpus", "LIST",
+                           "run only on these CPUs, e.g. 0-3,6");
+  args->nice    = arg_int0(NULL, "nice", "N",
+                           "run at nice value N (-20..19)");
+  args->cgroup  = arg_str0(NULL, "cgroup", "PATH",
+                           "run in this cgroup v2 group (relative to "
+                           "/sys/fs/cgroup)");
+  args->command = arg_strn(NULL, NULL, "COMMAND", 0, 100,
+                           "command or pipeline to run");
+  args->end     = arg_end(20);
+
+  args->argtable[0] = args->help;
+  args->argtable[1] = args->cpus;
+  args->argtable[2] = args->nice;
+  args->argtable[3] = args->cgroup;
+  args->argtable[4] = args->command;
+  args->argtable[5] = args->end;
+}
+
+
+/**
+ * Frees memory allocated for the run argtable.
+ *
+ * @param args Pointer to run_args_t structure to cleanup
+ */
+static void cleanup_run_argtable(run_args_t *args) {
+  arg_freetable(args->argtable,
+                sizeof(args->argtable) / sizeof(args->argtable[0]));
+}
+
+
+/**
+ * Prints usage information for the run command.
+ *
+ * @param out Output stream to write usage information to
+ */
+static void run_print_usage(FILE *out) {
+  run_args_t args;
+  build_run_argtable(&args);
+  fprintf(out, "Usage: run");
+  arg_print_syntax(out, args.argtable, "\n");
+  fprintf(out, "Run a command or pipeline with its processes placed on "
+               "some CPUs, at a\nnice value or in a cgroup, e.g. to keep "
+               "a background build from slowing\ninteractive commands. "
+               "Builtins run inside the shell and are not placed;\nlinked "
+               "apps run as child processes so that they are.\n\n");
+  fprintf(out, "Options:\n");
+  arg_print_glossary(out, args.argtable, "  %-20s %s\n");
+  cleanup_run_argtable(&args);
+}
+
+
+/**
+ * Passes the run argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void run_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  run_args_t args;
+  build_run_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_run_argtable(&args);
+}
+
+
+/**
+ * Executes the run command when the prefix was not taken off.
+ *
+ * @param argc Number of arguments
+ * @param argv Array of argument strings
+ * @return 0 for --help, 1 otherwise
+ */
+static int run_run(int argc, char **argv) {
+  run_args_t args;
+  build_run_argtable(&args);
+
+  int nerrors = arg_parse(argc, argv, args.argtable);
+
+  if (args.help->count > 0) {
+    run_print_usage(jshell_io_stdout());
+    cleanup_run_argtable(&args);
+    return 0;
+  }
+
+  if (nerrors > 0) {
+    arg_print_errors(stderr, args.end, "run");
+  } else {
+    fprintf(stderr, "run: missing command\n");
+  }
+  fprintf(stderr, "Try 'run --help' for more information.\n");
+  cleanup_run_argtable(&args);
+  return 1;
+}
+
+
+/**
+ * Command specification for the run builtin.
+ */
+const jshell_cmd_spec_t cmd_run_spec = {
+  .name = "run",
+  .summary = "run a command on chosen CPUs, nice value or cgroup",
+  .long_help = "Run a command or pipeline with sched_setaffinity(), "
+               "setpriority() and a\ncgroup v2 placement applied to its "
+               "processes. Background jobs show the\nplacement in "
+               "`jobs --json`.",
+  .type = CMD_BUILTIN,
+  .run = run_run,
+  .print_usage = run_print_usage,
+  .describe_args = run_describe_args
+};
+
+
+/**
+ * Registers the run command with the shell command registry.
+ */
+void jshell_register_run_command(void) {
+  jshell_register_command(&cmd_run_spec);
+}
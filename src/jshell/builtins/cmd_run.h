@@ -0,0 +1,12 @@
+#ifndef CMD_RUN_H
+#define CMD_RUN_H
+
+#include "jshell/jshell_cmd_registry.h"
+
+
+extern const jshell_cmd_spec_t cmd_run_spec;
+
+void jshell_register_run_command(void);
+
+
+#endif
@@ -0,0 +1,211 @@
+/**
+ * @file cmd_stats.c
+ * @brief Implementation of the stats builtin for the shell's runtime counters
+ *
+ * Prints the counters of jshell_stats: commands run by kind, children
+ * started, cache hit rates, bytes captured by command substitution, AI
+ * requests and package reloads, summed over all threads of the shell and,
+ * under --serve, over the server and all its connections.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "argtable3.h"
+#include "jshell/jshell_cmd_registry.h"
+#include "jshell/jshell_io.h"
+#include "jshell/jshell_stats.h"
+
+
+/**
+ * Arguments structure for the stats command.
+ */
+typedef struct {
+  struct arg_lit *help;
+  struct arg_lit *reset;
+  struct arg_lit *json;
+  struct arg_end *end;
+  void *argtable[4];
+} stats_args_t;
+
+
+/**
+ * Builds the argtable3 structure for the stats command.
+ *
+ * @param args Pointer to stats_args_t structure to populate
+ */
+static void build_stats_argtable(stats_args_t *args) {
+  args->help  = arg_lit0("h", "help", "display this help and exit");
+  args->reset = arg_lit0("r", "reset",
+                         "start counting from zero after printing");
+  args->json  = arg_lit0(NULL, "json", "output in JSON format");
+  args->end   = arg_end(20);
+
+  args->argtable[0] = args->help;
+  args->argtable[1] = args->reset;
+  args->argtable[2] = args->json;
+  args->argtable[3] = args->end;
+}
+
+
+/**
+ * Frees memory allocated for the stats argtable.
+ *
+ * @param args Pointer to stats_args_t structure to cleanup
+ */
+static void cleanup_stats_argtable(stats_args_t *args) {
+  arg_freetable(args->argtable,
+                sizeof(args->argtable) / sizeof(args->argtable[0]));
+}
+
+
+/**
+ * Prints usage information for the stats command.
+ *
+ * @param out Output stream to write usage information to
+ */
+static void stats_print_usage(FILE *out) {
+  stats_args_t args;
+  build_stats_argtable(&args);
+  fprintf(out, "Usage: stats");
+  arg_print_syntax(out, args.argtable, "\n");
+  fprintf(out, "Print the shell's runtime counters.\n\n");
+  fprintf(out, "Counts commands run by kind, children started, PATH and\n");
+  fprintf(out, "parse cache lookups, bytes captured by command\n");
+  fprintf(out, "substitution, AI requests and package reloads, over all\n");
+  fprintf(out, "threads of the shell. Under --serve the counts include\n");
+  fprintf(out, "the server and all its connections.\n\n");
+  fprintf(out, "Options:\n");
+  arg_print_glossary(out, args.argtable, "  %-20s %s\n");
+  cleanup_stats_argtable(&args);
+}
+
+
+/**
+ * Passes the stats argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void stats_describe_args(jshell_argtable_visit_fn visit,
+                                void *userdata) {
+  stats_args_t args;
+  build_stats_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_stats_argtable(&args);
+}
+
+
+/**
+ * Computes the share of hits among lookups.
+ *
+ * @param hits Lookups answered from a cache
+ * @param misses Lookups that were not
+ * @return Hit rate between 0 and 1, or 0 with no lookups
+ */
+static double hit_rate(uint64_t hits, uint64_t misses) {
+  return hits + misses > 0 ? (double)hits / (double)(hits + misses) : 0.0;
+}
+
+
+/**
+ * Prints the counters and the rates derived from them.
+ *
+ * @param totals Counters from jshell_stats_read()
+ * @param show_json Whether to print one JSON object
+ */
+static void print_stats(const uint64_t totals[JSHELL_STAT_COUNT],
+                        int show_json) {
+  double path_rate = hit_rate(totals[JSHELL_STAT_PATH_HITS],
+                              totals[JSHELL_STAT_PATH_MISSES]);
+  double parse_rate = hit_rate(totals[JSHELL_STAT_PARSE_HITS],
+                               totals[JSHELL_STAT_PARSE_MISSES]);
+  uint64_t requests = totals[JSHELL_STAT_AI_REQUESTS];
+  double ai_avg_ms = requests > 0
+      ? (double)totals[JSHELL_STAT_AI_LATENCY_US] / 1000.0 / (double)requests
+      : 0.0;
+
+  if (show_json) {
+    jshell_printf("{");
+    for (int i = 0; i < JSHELL_STAT_COUNT; i++) {
+      jshell_printf("\"%s\": %" PRIu64 ", ", jshell_stats_name(i), totals[i]);
+    }
+    jshell_printf("\"path_cache_hit_rate\": %.4f, "
+                  "\"parse_cache_hit_rate\": %.4f, "
+                  "\"ai_latency_avg_ms\": %.1f}\n",
+                  path_rate, parse_rate, ai_avg_ms);
+    return;
+  }
+
+  for (int i = 0; i < JSHELL_STAT_COUNT; i++) {
+    jshell_printf("%-22s %" PRIu64 "\n", jshell_stats_name(i), totals[i]);
+  }
+  jshell_printf("%-22s %.1f%%\n", "path_cache_hit_rate", path_rate * 100.0);
+  jshell_printf("%-22s %.1f%%\n", "parse_cache_hit_rate", parse_rate * 100.0);
+  jshell_printf("%-22s %.1f ms\n", "ai_latency_avg", ai_avg_ms);
+}
+
+
+/**
+ * Executes the stats command.
+ *
+ * @param argc Number of arguments
+ * @param argv Array of argument strings
+ * @return 0 on success, 1 on failure
+ */
+static int stats_run(int argc, char **argv) {
+  stats_args_t args;
+  build_stats_argtable(&args);
+
+  int nerrors = arg_parse(argc, argv, args.argtable);
+
+  if (args.help->count > 0) {
+    stats_print_usage(jshell_io_stdout());
+    cleanup_stats_argtable(&args);
+    return 0;
+  }
+
+  if (nerrors > 0) {
+    arg_print_errors(stderr, args.end, "stats");
+    fprintf(stderr, "Try 'stats --help' for more information.\n");
+    cleanup_stats_argtable(&args);
+    return 1;
+  }
+
+  uint64_t totals[JSHELL_STAT_COUNT];
+  jshell_stats_read(totals);
+  print_stats(totals, args.json->count > 0);
+
+  if (args.reset->count > 0) {
+    jshell_stats_reset();
+  }
+
+  cleanup_stats_argtable(&args);
+  return 0;
+}
+
+
+/**
+ * Command specification for the stats builtin.
+ */
+const jshell_cmd_spec_t cmd_stats_spec = {
+  .name = "stats",
+  .summary = "print the shell's runtime counters",
+  .long_help = "Print counters of commands run by kind, children started, "
+               "cache hit rates, captured bytes, AI requests and package "
+               "reloads; -r starts again from zero.",
+  .type = CMD_BUILTIN,
+  .run = stats_run,
+  .print_usage = stats_print_usage,
+  .describe_args = stats_describe_args
+};
+
+
+/**
+ * Registers the stats command with the shell command registry.
+ */
+void jshell_register_stats_command(void) {
+  jshell_register_command(&cmd_stats_spec);
+}
@@ -0,0 +1,12 @@
+#ifndef CMD_STATS_H
+#define CMD_STATS_H
+
+#include "jshell/jshell_cmd_registry.h"
+
+
+extern const jshell_cmd_spec_t cmd_stats_spec;
+
+void jshell_register_stats_command(void);
+
+
+#endif
@@ -0,0 +1,146 @@
+/**
+ * @file cmd_time.c
+ * @brief Help for the time prefix, which the interpreter handles
+ *
+ * `time [--json] command ...` is stripped from a job before it runs and
+ * the job is timed as a whole (see jshell_ast_interpreter.c). This
+ * builtin is only reached without a command, e.g. for `time --help`.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "argtable3.h"
+#include "jshell/jshell_cmd_registry.h"
+#include "jshell/jshell_io.h"
+
+
+/**
+ * Arguments structure for the time command.
+ */
+typedef struct {
+  struct arg_lit *help;
+  struct arg_lit *json;
+  struct arg_str *command;
+  struct arg_end *end;
+  void *argtable[4];
+} time_args_t;
+
+
+/**
+ * Builds the argtable3 structure for the time command.
+ *
+ * @param args Pointer to time_args_t structure to populate
+ */
+static void build_time_argtable(time_args_t *args) {
+  args->help    = arg_lit0("h", "help", "display this help and exit");
+  args->json    = arg_lit0(NULL, "json", "report usage as JSON");
+  args->command = arg_strn(NULL, NULL, "COMMAND", 0, 100,
+                           "command or pipeline to time");
+  args->end     = arg_end(20);
+
+  args->argtable[0] = args->help;
+  args->argtable[1] = args->json;
+  args->argtable[2] = args->command;
+  args->argtable[3] = args->end;
+}
+
+
+/**
+ * Frees memory allocated for the time argtable.
+ *
+ * @param args Pointer to time_args_t structure to cleanup
+ */
+static void cleanup_time_argtable(time_args_t *args) {
+  arg_freetable(args->argtable,
+                sizeof(args->argtable) / sizeof(args->argtable[0]));
+}
+
+
+/**
+ * Prints usage information for the time command.
+ *
+ * @param out Output stream to write usage information to
+ */
+static void time_print_usage(FILE *out) {
+  time_args_t args;
+  build_time_argtable(&args);
+  fprintf(out, "Usage: time");
+  arg_print_syntax(out, args.argtable, "\n");
+  fprintf(out, "Run a command or pipeline and report its elapsed time, "
+               "CPU time and\npeak memory on stderr, in total and per "
+               "pipeline stage.\n\n");
+  fprintf(out, "Options:\n");
+  arg_print_glossary(out, args.argtable, "  %-20s %s\n");
+  cleanup_time_argtable(&args);
+}
+
+
+/**
+ * Passes the time argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void time_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  time_args_t args;
+  build_time_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_time_argtable(&args);
+}
+
+
+/**
+ * Executes the time command when no command followed it.
+ *
+ * @param argc Number of arguments
+ * @param argv Array of argument strings
+ * @return 0 for --help, 1 otherwise
+ */
+static int time_run(int argc, char **argv) {
+  time_args_t args;
+  build_time_argtable(&args);
+
+  int nerrors = arg_parse(argc, argv, args.argtable);
+
+  if (args.help->count > 0) {
+    time_print_usage(jshell_io_stdout());
+    cleanup_time_argtable(&args);
+    return 0;
+  }
+
+  if (nerrors > 0) {
+    arg_print_errors(stderr, args.end, "time");
+  } else {
+    fprintf(stderr, "time: missing command\n");
+  }
+  fprintf(stderr, "Try 'time --help' for more information.\n");
+  cleanup_time_argtable(&args);
+  return 1;
+}
+
+
+/**
+ * Command specification for the time builtin.
+ */
+const jshell_cmd_spec_t cmd_time_spec = {
+  .name = "time",
+  .summary = "report the time and memory a command uses",
+  .long_help = "Run a command or pipeline and report wall time, user and "
+               "system CPU time\nand peak resident memory on stderr, in "
+               "total and for each pipeline stage.\nWith --json the report "
+               "is a single JSON object.",
+  .type = CMD_BUILTIN,
+  .run = time_run,
+  .print_usage = time_print_usage,
+  .describe_args = time_describe_args
+};
+
+
+/**
+ * Registers the time command with the shell command registry.
+ */
+void jshell_register_time_command(void) {
+  jshell_register_command(&cmd_time_spec);
+}
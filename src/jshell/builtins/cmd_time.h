@@ -0,0 +1,12 @@
+#ifndef CMD_TIME_H
+#define CMD_TIME_H
+
+#include "jshell/jshell_cmd_registry.h"
+
+
+extern const jshell_cmd_spec_t cmd_time_spec;
+
+void jshell_register_time_command(void);
+
+
+#endif
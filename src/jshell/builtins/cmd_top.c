@@ -0,0 +1,959 @@
+/**
+ * @file cmd_top.c
+ * @brief Implementation of the top builtin for watching processes
+ *
+ * Each process watched keeps its /proc/<pid>/stat open, and a sample is
+ * one pread() of it, as for /proc/stat, /proc/meminfo and /proc/loadavg;
+ * only processes seen for the first time cost an open() and a read of
+ * their command line. A descriptor outlives the process it was opened
+ * for (reads fail with ESRCH), so a reused pid is never mistaken for the
+ * old one. CPU usage is the difference in clock ticks between two
+ * samples, so hundreds of processes are watched for a fraction of a
+ * percent of one core.
+ *
+ * On a terminal the table is drawn through jbox_screen, which sends only
+ * the cells that changed since the last frame. Otherwise frames are
+ * printed as text, or with --json as one object per line for as long as
+ * the reader wants them.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+
+#include "argtable3.h"
+#include "jshell/jshell_cmd_registry.h"
+#include "jshell/jshell_io.h"
+#include "jshell/jshell_job_control.h"
+#include "jshell/jshell_signals.h"
+#include "utils/jbox_json.h"
+#include "utils/jbox_screen.h"
+
+
+/** Most PIDs accepted on one command line */
+#define TOP_MAX_PID_ARGS 256
+
+/** Bytes read from a /proc file at a time */
+#define TOP_READ_SIZE 4096
+
+/** Longest command line kept for a process */
+#define TOP_COMMAND_MAX 512
+
+/** Seconds between frames unless --interval says otherwise */
+#define TOP_DEFAULT_INTERVAL 1.0
+
+/** Most milliseconds the first frame waits for its CPU figures */
+#define TOP_FIRST_MS 200
+
+/** Milliseconds between checks for a key or an interrupt */
+#define TOP_POLL_MS 100
+
+/** Rows above the process table on a terminal */
+#define TOP_HEADER_ROWS 3
+
+
+/**
+ * Argument table structure for the top command
+ */
+typedef struct {
+  struct arg_lit *help;
+  struct arg_lit *json;
+  struct arg_dbl *interval;
+  struct arg_int *iterations;
+  struct arg_int *limit;
+  struct arg_lit *jobs;
+  struct arg_str *pid;
+  struct arg_end *end;
+  void *argtable[8];
+} top_args_t;
+
+
+/**
+ * A process being watched
+ */
+typedef struct {
+  pid_t pid;
+  int fd;                       /* Its /proc/<pid>/stat, kept open */
+  int job_id;                   /* Shell job it belongs to, or 0 */
+  char state;                   /* R, S, D, Z, T, ... */
+  int threads;
+  long rss_kb;
+  unsigned long long ticks;     /* CPU time used, in clock ticks */
+  unsigned long long delta;     /* Ticks used since the sample before */
+  bool sampled;                 /* ticks holds an earlier sample */
+  char *command;
+} top_proc_t;
+
+
+/**
+ * State kept between samples
+ */
+typedef struct {
+  top_proc_t *procs;            /* Watched processes, by pid */
+  size_t count;
+  size_t cap;
+  DIR *proc_dir;                /* /proc, read again for new processes */
+  const pid_t *want;            /* Only these processes, if not NULL */
+  size_t want_count;
+  bool jobs_only;               /* Only the processes of the shell's jobs */
+
+  pid_t *job_pids;              /* Processes of the shell's jobs, by pid */
+  int *job_ids;
+  size_t job_count;
+  size_t job_cap;
+
+  int stat_fd;                  /* /proc/stat */
+  int meminfo_fd;               /* /proc/meminfo */
+  int loadavg_fd;               /* /proc/loadavg */
+  unsigned long long cpu_all;   /* Ticks of all CPUs at the last sample */
+  unsigned long long cpu_idle;
+  double cpu_percent;           /* Busy share of all CPUs, last interval */
+  unsigned long mem_total_kb;
+  unsigned long mem_avail_kb;
+  double load[3];
+
+  double hz;                    /* Clock ticks per second */
+  long page_kb;
+  struct timespec last;         /* When the last sample was taken */
+  double elapsed;               /* Seconds between the last two samples */
+  char *buf;                    /* TOP_READ_SIZE bytes for reading /proc */
+} top_t;
+
+
+/**
+ * Builds the argtable3 argument table for the top command.
+ *
+ * @param args Pointer to top_args_t structure to populate
+ */
+static void build_top_argtable(top_args_t *args) {
+  args->help = arg_lit0("h", "help", "display this help and exit");
+  args->json = arg_lit0(NULL, "json",
+                        "print each sample as one JSON object per line");
+  args->interval = arg_dbl0("d", "interval", "SECONDS",
+                            "time between samples (default 1)");
+  args->iterations = arg_int0("n", "iterations", "N",
+                              "stop after N samples (default: 1 when not "
+                              "on a terminal without --json, else no limit)");
+  args->limit = arg_int0("l", "limit", "N",
+                         "show the N busiest processes only");
+  args->jobs = arg_lit0("j", "jobs",
+                        "only watch the processes of the shell's jobs");
+  args->pid = arg_strn("p", "pid", "PID", 0, TOP_MAX_PID_ARGS,
+                       "only watch process PID (repeatable)");
+  args->end = arg_end(20);
+
+  args->argtable[0] = args->help;
+  args->argtable[1] = args->json;
+  args->argtable[2] = args->interval;
+  args->argtable[3] = args->iterations;
+  args->argtable[4] = args->limit;
+  args->argtable[5] = args->jobs;
+  args->argtable[6] = args->pid;
+  args->argtable[7] = args->end;
+}
+
+
+/**
+ * Cleans up the argtable3 argument table for the top command.
+ *
+ * @param args Pointer to top_args_t structure to free
+ */
+static void cleanup_top_argtable(top_args_t *args) {
+  arg_freetable(args->argtable,
+                sizeof(args->argtable) / sizeof(args->argtable[0]));
+}
+
+
+/**
+ * Prints usage information for the top command.
+ *
+ * @param out Output stream to write to
+ */
+static void top_print_usage(FILE *out) {
+  top_args_t args;
+  build_top_argtable(&args);
+  fprintf(out, "Usage: top");
+  arg_print_syntax(out, args.argtable, "\n");
+  fprintf(out, "Show the busiest processes, sampled from /proc.\n\n");
+  fprintf(out, "Options:\n");
+  arg_print_glossary(out, args.argtable, "  %-20s %s\n");
+  fprintf(out, "\nOn a terminal, press q to quit.\n");
+  cleanup_top_argtable(&args);
+}
+
+
+/**
+ * Passes the top argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void top_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  top_args_t args;
+  build_top_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_top_argtable(&args);
+}
+
+
+/**
+ * Reads a /proc file from its start into the state's buffer.
+ *
+ * @param top State
+ * @param fd Open descriptor of the file
+ * @return Bytes read, NUL-terminated, or -1 on error
+ */
+static ssize_t read_proc(top_t *top, int fd) {
+  ssize_t n;
+  do {
+    n = pread(fd, top->buf, TOP_READ_SIZE - 1, 0);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0) return -1;
+  top->buf[n] = '\0';
+  return n;
+}
+
+
+/**
+ * Opens a file under /proc.
+ *
+ * @param path Path of the file
+ * @return Descriptor, or -1 on error
+ */
+static int open_proc(const char *path) {
+  return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+
+/**
+ * Compares two PIDs for qsort() and bsearch().
+ */
+static int compare_pids(const void *a, const void *b) {
+  pid_t x = *(const pid_t *)a;
+  pid_t y = *(const pid_t *)b;
+  return (x > y) - (x < y);
+}
+
+
+/**
+ * Finds where a process is, or would go, among the watched ones.
+ *
+ * @param top State
+ * @param pid Process ID
+ * @return Index of the first watched process with a pid not below pid
+ */
+static size_t find_proc(const top_t *top, pid_t pid) {
+  size_t lo = 0, hi = top->count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (top->procs[mid].pid < pid) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+
+/**
+ * Reads a process's command line, with its arguments joined by spaces.
+ *
+ * @param top State
+ * @param pid Process ID
+ * @return The command line, or NULL if it is empty (kernel threads) or
+ *         could not be read
+ */
+static char *read_command(top_t *top, pid_t pid) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/cmdline", (int)pid);
+  int fd = open_proc(path);
+  if (fd < 0) return NULL;
+  ssize_t n = read_proc(top, fd);
+  close(fd);
+  if (n <= 0) return NULL;
+
+  if (n > TOP_COMMAND_MAX) n = TOP_COMMAND_MAX;
+  while (n > 0 && top->buf[n - 1] == '\0') n--;
+  /* Shown on one line: arguments may hold newlines too */
+  for (ssize_t i = 0; i < n; i++) {
+    if ((unsigned char)top->buf[i] < ' ') top->buf[i] = ' ';
+  }
+  return strndup(top->buf, (size_t)n);
+}
+
+
+/**
+ * Starts watching a process.
+ *
+ * @param top State
+ * @param at Index to insert it at, as given by find_proc()
+ * @param pid Process ID
+ * @return 0 on success, -1 if it is gone or out of memory
+ */
+static int add_proc(top_t *top, size_t at, pid_t pid) {
+  if (top->count == top->cap) {
+    size_t cap = top->cap ? top->cap * 2 : 256;
+    top_proc_t *procs = realloc(top->procs, cap * sizeof(*procs));
+    if (!procs) return -1;
+    top->procs = procs;
+    top->cap = cap;
+  }
+
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+  int fd = open_proc(path);
+  if (fd < 0) return -1;
+
+  memmove(top->procs + at + 1, top->procs + at,
+          (top->count - at) * sizeof(*top->procs));
+  top->procs[at] = (top_proc_t){
+    .pid = pid,
+    .fd = fd,
+    .command = read_command(top, pid)
+  };
+  top->count++;
+  return 0;
+}
+
+
+/**
+ * Stops watching a process.
+ *
+ * @param top State
+ * @param at Index of the process
+ */
+static void remove_proc(top_t *top, size_t at) {
+  close(top->procs[at].fd);
+  free(top->procs[at].command);
+  memmove(top->procs + at, top->procs + at + 1,
+          (top->count - at - 1) * sizeof(*top->procs));
+  top->count--;
+}
+
+
+/**
+ * Callback collecting the processes of the shell's jobs.
+ *
+ * @param job Background job
+ * @param userdata Pointer to top_t
+ */
+static void collect_job_pids(const BackgroundJob *job, void *userdata) {
+  top_t *top = userdata;
+  for (size_t i = 0; i < job->pid_count; i++) {
+    if (top->job_count == top->job_cap) {
+      size_t cap = top->job_cap ? top->job_cap * 2 : 16;
+      pid_t *pids = realloc(top->job_pids, cap * sizeof(*pids));
+      if (!pids) return;
+      top->job_pids = pids;
+      int *ids = realloc(top->job_ids, cap * sizeof(*ids));
+      if (!ids) return;
+      top->job_ids = ids;
+      top->job_cap = cap;
+    }
+    top->job_pids[top->job_count] = job->pids[i];
+    top->job_ids[top->job_count] = job->job_id;
+    top->job_count++;
+  }
+}
+
+
+/**
+ * Finds the job a process belongs to.
+ *
+ * @param top State, with the jobs collected
+ * @param pid Process ID
+ * @return Job ID, or 0 if the process is not one of a job's
+ */
+static int job_of(const top_t *top, pid_t pid) {
+  for (size_t i = 0; i < top->job_count; i++) {
+    if (top->job_pids[i] == pid) return top->job_ids[i];
+  }
+  return 0;
+}
+
+
+/**
+ * Adds the processes to watch that are not watched yet: those given,
+ * those of the shell's jobs, or any new entry in /proc.
+ *
+ * @param top State
+ */
+static void find_new_procs(top_t *top) {
+  if (top->want) {
+    for (size_t i = 0; i < top->want_count; i++) {
+      size_t at = find_proc(top, top->want[i]);
+      if (at == top->count || top->procs[at].pid != top->want[i]) {
+        add_proc(top, at, top->want[i]);
+      }
+    }
+    return;
+  }
+
+  if (top->jobs_only) {
+    for (size_t i = 0; i < top->job_count; i++) {
+      size_t at = find_proc(top, top->job_pids[i]);
+      if (at == top->count || top->procs[at].pid != top->job_pids[i]) {
+        add_proc(top, at, top->job_pids[i]);
+      }
+    }
+    return;
+  }
+
+  if (!top->proc_dir) return;
+  rewinddir(top->proc_dir);
+  struct dirent *entry;
+  while ((entry = readdir(top->proc_dir)) != NULL) {
+    const char *name = entry->d_name;
+    if (name[0] < '1' || name[0] > '9') continue;
+    char *end;
+    long pid = strtol(name, &end, 10);
+    if (*end != '\0') continue;
+    size_t at = find_proc(top, (pid_t)pid);
+    if (at == top->count || top->procs[at].pid != (pid_t)pid) {
+      add_proc(top, at, (pid_t)pid);
+    }
+  }
+}
+
+
+/**
+ * Samples a watched process.
+ *
+ * @param top State
+ * @param proc Process
+ * @return 0 on success, -1 if the process has gone
+ */
+static int sample_proc(top_t *top, top_proc_t *proc) {
+  if (read_proc(top, proc->fd) <= 0) return -1;
+
+  /* The name in parentheses may itself hold spaces and parentheses */
+  char *fields = strrchr(top->buf, ')');
+  if (!fields) return -1;
+  char *name = strchr(top->buf, '(');
+
+  char state;
+  unsigned long long utime, stime;
+  int threads;
+  long rss;
+  if (sscanf(fields + 1,
+             " %c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu"
+             " %*d %*d %*d %*d %d %*d %*u %*u %ld",
+             &state, &utime, &stime, &threads, &rss) != 5) {
+    return -1;
+  }
+
+  if (!proc->command && name && name < fields) {
+    /* No command line: a kernel thread, or a zombie */
+    proc->command = malloc((size_t)(fields - name) + 2);
+    if (proc->command) {
+      snprintf(proc->command, (size_t)(fields - name) + 2, "[%.*s]",
+               (int)(fields - name - 1), name + 1);
+    }
+  }
+
+  unsigned long long ticks = utime + stime;
+  proc->delta = proc->sampled && ticks >= proc->ticks ?
+                ticks - proc->ticks : 0;
+  proc->ticks = ticks;
+  proc->sampled = true;
+  proc->state = state;
+  proc->threads = threads;
+  proc->rss_kb = rss * top->page_kb;
+  return 0;
+}
+
+
+/**
+ * Samples the CPU, memory and load figures of the whole system.
+ *
+ * @param top State
+ */
+static void sample_system(top_t *top) {
+  if (top->stat_fd >= 0 && read_proc(top, top->stat_fd) > 0) {
+    unsigned long long v[8] = {0};
+    sscanf(top->buf, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+           &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]);
+    unsigned long long all = 0;
+    for (int i = 0; i < 8; i++) all += v[i];
+    unsigned long long idle = v[3] + v[4];    /* idle and iowait */
+    if (top->cpu_all > 0 && all > top->cpu_all) {
+      unsigned long long d_all = all - top->cpu_all;
+      unsigned long long d_idle = idle >= top->cpu_idle ?
+                                  idle - top->cpu_idle : 0;
+      if (d_idle > d_all) d_idle = d_all;
+      top->cpu_percent = 100.0 * (double)(d_all - d_idle) / (double)d_all;
+    }
+    top->cpu_all = all;
+    top->cpu_idle = idle;
+  }
+
+  if (top->meminfo_fd >= 0 && read_proc(top, top->meminfo_fd) > 0) {
+    char *p = strstr(top->buf, "MemTotal:");
+    if (p) top->mem_total_kb = strtoul(p + 9, NULL, 10);
+    p = strstr(top->buf, "MemAvailable:");
+    if (p) top->mem_avail_kb = strtoul(p + 13, NULL, 10);
+  }
+
+  if (top->loadavg_fd >= 0 && read_proc(top, top->loadavg_fd) > 0) {
+    sscanf(top->buf, "%lf %lf %lf", &top->load[0], &top->load[1],
+           &top->load[2]);
+  }
+}
+
+
+/**
+ * Takes a sample of the system and of every process watched.
+ *
+ * @param top State
+ */
+static void top_sample(top_t *top) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  top->elapsed = (double)(now.tv_sec - top->last.tv_sec) +
+                 (double)(now.tv_nsec - top->last.tv_nsec) / 1e9;
+  top->last = now;
+
+  top->job_count = 0;
+  jshell_for_each_job(collect_job_pids, top);
+  find_new_procs(top);
+
+  for (size_t i = 0; i < top->count;) {
+    if (sample_proc(top, &top->procs[i]) != 0) {
+      remove_proc(top, i);
+      continue;
+    }
+    top->procs[i].job_id = job_of(top, top->procs[i].pid);
+    i++;
+  }
+  sample_system(top);
+}
+
+
+/**
+ * Orders processes by CPU used since the sample before, busiest first.
+ */
+static int compare_busy(const void *a, const void *b) {
+  const top_proc_t *x = *(top_proc_t *const *)a;
+  const top_proc_t *y = *(top_proc_t *const *)b;
+  if (x->delta != y->delta) return x->delta < y->delta ? 1 : -1;
+  if (x->ticks != y->ticks) return x->ticks < y->ticks ? 1 : -1;
+  return (x->pid > y->pid) - (x->pid < y->pid);
+}
+
+
+/**
+ * Lists the watched processes, busiest first.
+ *
+ * @param top State
+ * @param count Set to the number of processes listed
+ * @return Array of pointers into top->procs, or NULL if out of memory
+ */
+static top_proc_t **sorted_procs(top_t *top, size_t *count) {
+  top_proc_t **order = malloc((top->count ? top->count : 1) *
+                              sizeof(*order));
+  if (!order) return NULL;
+  for (size_t i = 0; i < top->count; i++) order[i] = &top->procs[i];
+  qsort(order, top->count, sizeof(*order), compare_busy);
+  *count = top->count;
+  return order;
+}
+
+
+/**
+ * Gives a process's share of one CPU since the sample before.
+ *
+ * @param top State
+ * @param proc Process
+ * @return Percentage; above 100 for a process busy on several CPUs
+ */
+static double proc_cpu_percent(const top_t *top, const top_proc_t *proc) {
+  if (top->elapsed <= 0) return 0;
+  return 100.0 * (double)proc->delta / (top->hz * top->elapsed);
+}
+
+
+/**
+ * Formats the summary line above the table.
+ *
+ * @param top State
+ * @param buf Buffer
+ * @param size Size of buf
+ * @return Length of the line
+ */
+static int format_summary(const top_t *top, char *buf, size_t size) {
+  unsigned long used_kb = top->mem_total_kb > top->mem_avail_kb ?
+                          top->mem_total_kb - top->mem_avail_kb : 0;
+  int len = snprintf(buf, size,
+                     "top - %zu processes, cpu %.1f%%, load %.2f %.2f %.2f, "
+                     "mem %lu/%lu MiB",
+                     top->count, top->cpu_percent, top->load[0],
+                     top->load[1], top->load[2], used_kb / 1024,
+                     top->mem_total_kb / 1024);
+  return len < (int)size ? len : (int)size - 1;
+}
+
+
+/** Heading of the table, matching format_row() */
+static const char top_heading[] =
+  "    PID   JOB S  %CPU      RSS      TIME THR COMMAND";
+
+
+/**
+ * Formats one row of the table.
+ *
+ * @param top State
+ * @param proc Process
+ * @param buf Buffer
+ * @param size Size of buf
+ * @return Length of the row
+ */
+static int format_row(const top_t *top, const top_proc_t *proc, char *buf,
+                      size_t size) {
+  char job[16] = "-";
+  if (proc->job_id > 0) snprintf(job, sizeof(job), "%%%d", proc->job_id);
+
+  unsigned long long centis = (unsigned long long)
+                              ((double)proc->ticks * 100.0 / top->hz);
+  char time_str[32];
+  snprintf(time_str, sizeof(time_str), "%llu:%02llu.%02llu",
+           centis / 6000, centis / 100 % 60, centis % 100);
+
+  int len = snprintf(buf, size, "%7d %5s %c %5.1f %8ld %9s %3d %s",
+                     (int)proc->pid, job, proc->state,
+                     proc_cpu_percent(top, proc), proc->rss_kb, time_str,
+                     proc->threads, proc->command ? proc->command : "?");
+  return len < (int)size ? len : (int)size - 1;
+}
+
+
+/**
+ * Prints a frame as text.
+ *
+ * @param top State
+ * @param limit Most processes to show, or 0 for all
+ */
+static void print_text_frame(top_t *top, size_t limit) {
+  size_t count = 0;
+  top_proc_t **order = sorted_procs(top, &count);
+  if (!order) return;
+  if (limit > 0 && count > limit) count = limit;
+
+  char line[TOP_COMMAND_MAX + 128];
+  format_summary(top, line, sizeof(line));
+  jshell_printf("%s\n\n%s\n", line, top_heading);
+  for (size_t i = 0; i < count; i++) {
+    format_row(top, order[i], line, sizeof(line));
+    jshell_printf("%s\n", line);
+  }
+  free(order);
+}
+
+
+/**
+ * Prints a frame as one line of JSON.
+ *
+ * @param top State
+ * @param limit Most processes to include, or 0 for all
+ */
+static void print_json_frame(top_t *top, size_t limit) {
+  size_t count = 0;
+  top_proc_t **order = sorted_procs(top, &count);
+  if (!order) return;
+  if (limit > 0 && count > limit) count = limit;
+
+  FILE *out = jshell_io_stdout();
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  fprintf(out, "{\"time_ms\": %lld, \"interval_ms\": %.0f, "
+               "\"processes_watched\": %zu, \"cpu_percent\": %.1f, "
+               "\"load\": [%.2f, %.2f, %.2f], \"mem_total_kb\": %lu, "
+               "\"mem_available_kb\": %lu, \"processes\": [",
+          (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000,
+          top->elapsed * 1000.0, top->count, top->cpu_percent,
+          top->load[0], top->load[1], top->load[2], top->mem_total_kb,
+          top->mem_avail_kb);
+  for (size_t i = 0; i < count; i++) {
+    const top_proc_t *proc = order[i];
+    fprintf(out, "%s{\"pid\": %d, ", i > 0 ? ", " : "", (int)proc->pid);
+    if (proc->job_id > 0) fprintf(out, "\"job_id\": %d, ", proc->job_id);
+    fprintf(out, "\"state\": \"%c\", \"cpu_percent\": %.1f, "
+                 "\"cpu_time_ms\": %.0f, \"rss_kb\": %ld, \"threads\": %d, "
+                 "\"command\": ",
+            proc->state, proc_cpu_percent(top, proc),
+            (double)proc->ticks * 1000.0 / top->hz, proc->rss_kb,
+            proc->threads);
+    jbox_json_write_string(out, proc->command ? proc->command : "");
+    fputc('}', out);
+  }
+  fprintf(out, "]}\n");
+  fflush(out);
+  free(order);
+}
+
+
+/**
+ * Draws a frame on the terminal.
+ *
+ * @param top State
+ * @param screen Renderer
+ * @param rows Terminal rows
+ * @param limit Most processes to show, or 0 for as many as fit
+ */
+static void draw_frame(top_t *top, jbox_screen_t *screen, int rows,
+                       size_t limit) {
+  size_t count = 0;
+  top_proc_t **order = sorted_procs(top, &count);
+  if (!order) return;
+  size_t fit = rows > TOP_HEADER_ROWS ? (size_t)(rows - TOP_HEADER_ROWS) : 0;
+  if (count > fit) count = fit;
+  if (limit > 0 && count > limit) count = limit;
+
+  char line[TOP_COMMAND_MAX + 128];
+  int len = format_summary(top, line, sizeof(line));
+  jbox_screen_clear(screen);
+  jbox_screen_put(screen, 0, 0, line, (size_t)len, 0);
+  jbox_screen_put(screen, 2, 0, top_heading, sizeof(top_heading) - 1,
+                  JBOX_SCREEN_REVERSE);
+  for (size_t i = 0; i < count; i++) {
+    len = format_row(top, order[i], line, sizeof(line));
+    jbox_screen_put(screen, TOP_HEADER_ROWS + (int)i, 0, line, (size_t)len,
+                    0);
+  }
+  jbox_screen_set_cursor(screen, -1, 0);
+  jbox_screen_flush(screen);
+  free(order);
+}
+
+
+/**
+ * Waits until the next sample is due, a key is pressed or the shell is
+ * interrupted.
+ *
+ * @param key_fd Terminal to read keys from, or -1
+ * @param ms Milliseconds to wait
+ * @return 1 to go on, 0 to stop
+ */
+static int wait_next(int key_fd, long ms) {
+  struct timespec start, now;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (;;) {
+    if (jshell_is_interrupted()) return 0;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long waited = (now.tv_sec - start.tv_sec) * 1000 +
+                  (now.tv_nsec - start.tv_nsec) / 1000000;
+    if (waited >= ms) return 1;
+    long slice = ms - waited < TOP_POLL_MS ? ms - waited : TOP_POLL_MS;
+
+    struct pollfd pfd = { .fd = key_fd, .events = POLLIN };
+    int n = poll(&pfd, key_fd >= 0 ? 1 : 0, (int)slice);
+    if (n > 0) {
+      char key;
+      if (read(key_fd, &key, 1) != 1) return 0;
+      if (key == 'q' || key == 'Q' || key == 3 || key == 27) return 0;
+    }
+  }
+}
+
+
+/**
+ * Frees the state.
+ *
+ * @param top State
+ */
+static void top_free(top_t *top) {
+  while (top->count > 0) remove_proc(top, top->count - 1);
+  free(top->procs);
+  free(top->job_pids);
+  free(top->job_ids);
+  if (top->proc_dir) closedir(top->proc_dir);
+  if (top->stat_fd >= 0) close(top->stat_fd);
+  if (top->meminfo_fd >= 0) close(top->meminfo_fd);
+  if (top->loadavg_fd >= 0) close(top->loadavg_fd);
+  free(top->buf);
+}
+
+
+/**
+ * Executes the top command.
+ *
+ * @param argc Argument count
+ * @param argv Argument vector
+ * @return Exit status (0 for success, non-zero for error)
+ */
+static int top_run(int argc, char **argv) {
+  top_args_t args;
+  build_top_argtable(&args);
+
+  int nerrors = arg_parse(argc, argv, args.argtable);
+
+  if (args.help->count > 0) {
+    top_print_usage(jshell_io_stdout());
+    cleanup_top_argtable(&args);
+    return 0;
+  }
+
+  if (nerrors > 0) {
+    arg_print_errors(stderr, args.end, "top");
+    fprintf(stderr, "Try 'top --help' for more information.\n");
+    cleanup_top_argtable(&args);
+    return 1;
+  }
+
+  double interval = args.interval->count > 0 ? args.interval->dval[0] :
+                    TOP_DEFAULT_INTERVAL;
+  if (interval < 0.01) {
+    fprintf(stderr, "top: interval must be at least 0.01 seconds\n");
+    cleanup_top_argtable(&args);
+    return 1;
+  }
+
+  pid_t want[TOP_MAX_PID_ARGS];
+  size_t want_count = 0;
+  for (int i = 0; i < args.pid->count; i++) {
+    char *end;
+    long pid = strtol(args.pid->sval[i], &end, 10);
+    if (*end != '\0' || pid <= 0) {
+      fprintf(stderr, "top: invalid PID: %s\n", args.pid->sval[i]);
+      cleanup_top_argtable(&args);
+      return 1;
+    }
+    want[want_count++] = (pid_t)pid;
+  }
+  qsort(want, want_count, sizeof(*want), compare_pids);
+
+  bool show_json = args.json->count > 0;
+  FILE *out = jshell_io_stdout();
+  int out_fd = fileno(out);
+  int key_fd = fileno(jshell_io_stdin());
+  bool interactive = !show_json && isatty(out_fd) && isatty(key_fd);
+  long iterations = args.iterations->count > 0 ? args.iterations->ival[0] :
+                    (interactive || show_json ? 0 : 1);
+  size_t limit = args.limit->count > 0 && args.limit->ival[0] > 0 ?
+                 (size_t)args.limit->ival[0] : 0;
+
+  top_t top = {
+    .want = want_count > 0 ? want : NULL,
+    .want_count = want_count,
+    .jobs_only = args.jobs->count > 0,
+    .stat_fd = open_proc("/proc/stat"),
+    .meminfo_fd = open_proc("/proc/meminfo"),
+    .loadavg_fd = open_proc("/proc/loadavg"),
+    .hz = (double)sysconf(_SC_CLK_TCK),
+    .page_kb = sysconf(_SC_PAGESIZE) / 1024,
+    .buf = malloc(TOP_READ_SIZE)
+  };
+  cleanup_top_argtable(&args);
+  if (top.hz <= 0) top.hz = 100;
+  if (!top.want && !top.jobs_only) top.proc_dir = opendir("/proc");
+  if (!top.buf || top.stat_fd < 0 ||
+      (!top.want && !top.jobs_only && !top.proc_dir)) {
+    fprintf(stderr, "top: cannot read /proc: %s\n", strerror(errno));
+    top_free(&top);
+    return 1;
+  }
+
+  struct termios saved;
+  jbox_screen_t *screen = NULL;
+  int rows = 24, cols = 80;
+  if (interactive) {
+    struct winsize ws;
+    if (ioctl(out_fd, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0) {
+      rows = ws.ws_row;
+      cols = ws.ws_col;
+    }
+    fflush(out);
+    screen = jbox_screen_new(out_fd, rows, cols);
+    if (!screen || tcgetattr(key_fd, &saved) != 0) {
+      fprintf(stderr, "top: cannot set up the terminal\n");
+      jbox_screen_free(screen);
+      top_free(&top);
+      return 1;
+    }
+    /* Keys one at a time, unechoed; Ctrl-C still interrupts the shell */
+    struct termios raw = saved;
+    raw.c_lflag &= (tcflag_t)~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(key_fd, TCSAFLUSH, &raw);
+  }
+
+  /* CPU figures are differences, so the first frame needs two samples */
+  clock_gettime(CLOCK_MONOTONIC, &top.last);
+  top_sample(&top);
+  long interval_ms = (long)(interval * 1000.0);
+  long wait_ms = interval_ms < TOP_FIRST_MS ? interval_ms : TOP_FIRST_MS;
+
+  int status = 0;
+  for (long frame = 0; iterations == 0 || frame < iterations; frame++) {
+    if (!wait_next(interactive ? key_fd : -1, frame == 0 ? wait_ms :
+                   interval_ms)) {
+      break;
+    }
+    top_sample(&top);
+
+    if (interactive) {
+      struct winsize ws;
+      if (ioctl(out_fd, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 &&
+          (ws.ws_row != rows || ws.ws_col != cols)) {
+        rows = ws.ws_row;
+        cols = ws.ws_col;
+        jbox_screen_resize(screen, rows, cols);
+      }
+      draw_frame(&top, screen, rows, limit);
+    } else if (show_json) {
+      print_json_frame(&top, limit);
+    } else {
+      if (frame > 0) jshell_printf("\n");
+      print_text_frame(&top, limit);
+    }
+    if (ferror(out)) {
+      status = 1;   /* The reader has gone */
+      break;
+    }
+  }
+
+  if (interactive) {
+    jbox_screen_clear(screen);
+    jbox_screen_set_cursor(screen, 0, 0);
+    jbox_screen_flush(screen);
+    jbox_screen_free(screen);
+    tcsetattr(key_fd, TCSAFLUSH, &saved);
+  }
+  if (jshell_is_interrupted()) status = 130;
+  top_free(&top);
+  return status;
+}
+
+
+/**
+ * Command specification for the top builtin
+ */
+const jshell_cmd_spec_t cmd_top_spec = {
+  .name = "top",
+  .summary = "show the busiest processes",
+  .long_help = "Sample /proc every interval and show the processes using\n"
+               "the most CPU, with the shell's job for each one that\n"
+               "belongs to a job. On a terminal the table is redrawn in\n"
+               "place; with --json each sample is one line of JSON.",
+  .type = CMD_BUILTIN,
+  .run = top_run,
+  .print_usage = top_print_usage,
+  .describe_args = top_describe_args
+};
+
+
+/**
+ * Registers the top command with the shell command registry.
+ */
+void jshell_register_top_command(void) {
+  jshell_register_command(&cmd_top_spec);
+}
@@ -0,0 +1,12 @@
+#ifndef CMD_TOP_H
+#define CMD_TOP_H
+
+#include "jshell/jshell_cmd_registry.h"
+
+
+extern const jshell_cmd_spec_t cmd_top_spec;
+
+void jshell_register_top_command(void);
+
+
+#endif
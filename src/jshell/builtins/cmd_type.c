@@ -11,6 +11,8 @@
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "jshell/jshell_io.h"
+#include "jshell/jshell_vars.h"
 
 
 /**
@@ -73,6 +75,20 @@ static void type_print_usage(FILE *out) {
 }
 
 
+/**
+ * Passes the type argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void type_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  type_args_t args;
+  build_type_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_type_argtable(&args);
+}
+
+
 /**
  * Escapes special characters in a string for JSON output.
  *
@@ -122,12 +138,7 @@ static char *find_in_path(const char *name) {
     return NULL;
   }
 
-  char *path_env = getenv("PATH");
-  if (path_env == NULL) {
-    return NULL;
-  }
-
-  char *path_copy = strdup(path_env);
+  char *path_copy = jshell_var_dup("PATH");
   if (path_copy == NULL) {
     return NULL;
   }
@@ -166,7 +177,7 @@ static int type_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    type_print_usage(stdout);
+    type_print_usage(jshell_io_stdout());
     cleanup_type_argtable(&args);
     return 0;
   }
@@ -183,7 +194,7 @@ static int type_run(int argc, char **argv) {
   int first = 1;
 
   if (show_json) {
-    printf("[\n");
+    jshell_printf("[\n");
   }
 
   for (int i = 0; i < args.names->count; i++) {
@@ -193,16 +204,17 @@ static int type_run(int argc, char **argv) {
     char escaped_name[256];
     if (show_json) {
       escape_json_string(name, escaped_name, sizeof(escaped_name));
-      if (!first) printf(",\n");
+      if (!first) jshell_printf(",\n");
       first = 0;
     }
 
     if (spec != NULL) {
       const char *kind = (spec->type == CMD_BUILTIN) ? "builtin" : "external";
       if (show_json) {
-        printf("{\"name\": \"%s\", \"kind\": \"%s\"}", escaped_name, kind);
+        jshell_printf("{\"name\": \"%s\", "
+                      "\"kind\": \"%s\"}", escaped_name, kind);
       } else {
-        printf("%s is a shell %s\n", name, kind);
+        jshell_printf("%s is a shell %s\n", name, kind);
       }
     } else {
       char *path = find_in_path(name);
@@ -210,15 +222,17 @@ static int type_run(int argc, char **argv) {
         if (show_json) {
           char escaped_path[PATH_MAX * 2];
           escape_json_string(path, escaped_path, sizeof(escaped_path));
-          printf("{\"name\": \"%s\", \"kind\": \"external\", \"path\": \"%s\"}",
-                 escaped_name, escaped_path);
+          jshell_printf("{\"name\": \"%s\", \"kind\": \"external\", "
+                        "\"path\": \"%s\"}",
+                        escaped_name, escaped_path);
         } else {
-          printf("%s is %s\n", name, path);
+          jshell_printf("%s is %s\n", name, path);
         }
         free(path);
       } else {
         if (show_json) {
-          printf("{\"name\": \"%s\", \"kind\": \"not found\"}", escaped_name);
+          jshell_printf("{\"name\": \"%s\", "
+                        "\"kind\": \"not found\"}", escaped_name);
         } else {
           fprintf(stderr, "type: %s: not found\n", name);
         }
@@ -228,7 +242,7 @@ static int type_run(int argc, char **argv) {
   }
 
   if (show_json) {
-    printf("\n]\n");
+    jshell_printf("\n]\n");
   }
 
   cleanup_type_argtable(&args);
@@ -246,7 +260,8 @@ const jshell_cmd_spec_t cmd_type_spec = {
                "as a command name.",
   .type = CMD_BUILTIN,
   .run = type_run,
-  .print_usage = type_print_usage
+  .print_usage = type_print_usage,
+  .describe_args = type_describe_args
 };
 
 
@@ -10,6 +10,8 @@
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "jshell/jshell_io.h"
+#include "jshell/jshell_vars.h"
 
 
 /**
@@ -72,6 +74,21 @@ static void unset_print_usage(FILE *out) {
 }
 
 
+/**
+ * Passes the unset argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void unset_describe_args(jshell_argtable_visit_fn visit,
+                                void *userdata) {
+  unset_args_t args;
+  build_unset_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_unset_argtable(&args);
+}
+
+
 /**
  * Escapes special characters in a string for JSON output.
  *
@@ -121,7 +138,7 @@ static int unset_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    unset_print_usage(stdout);
+    unset_print_usage(jshell_io_stdout());
     cleanup_unset_argtable(&args);
     return 0;
   }
@@ -138,22 +155,23 @@ static int unset_run(int argc, char **argv) {
   int first = 1;
 
   if (show_json) {
-    printf("[\n");
+    jshell_printf("[\n");
   }
 
   for (int i = 0; i < args.keys->count; i++) {
     const char *key = args.keys->sval[i];
 
-    if (unsetenv(key) != 0) {
+    if (jshell_var_unset(key) != 0) {
       if (show_json) {
         char escaped_key[256];
         char escaped_msg[256];
         escape_json_string(key, escaped_key, sizeof(escaped_key));
         escape_json_string(strerror(errno), escaped_msg, sizeof(escaped_msg));
-        if (!first) printf(",\n");
+        if (!first) jshell_printf(",\n");
         first = 0;
-        printf("{\"key\": \"%s\", \"status\": \"error\", \"message\": \"%s\"}",
-               escaped_key, escaped_msg);
+        jshell_printf("{\"key\": \"%s\", \"status\": \"error\", "
+                      "\"message\": \"%s\"}",
+                      escaped_key, escaped_msg);
       } else {
         fprintf(stderr, "unset: cannot unset '%s': %s\n", key, strerror(errno));
       }
@@ -162,15 +180,15 @@ static int unset_run(int argc, char **argv) {
       if (show_json) {
         char escaped_key[256];
         escape_json_string(key, escaped_key, sizeof(escaped_key));
-        if (!first) printf(",\n");
+        if (!first) jshell_printf(",\n");
         first = 0;
-        printf("{\"key\": \"%s\", \"status\": \"ok\"}", escaped_key);
+        jshell_printf("{\"key\": \"%s\", \"status\": \"ok\"}", escaped_key);
       }
     }
   }
 
   if (show_json) {
-    printf("\n]\n");
+    jshell_printf("\n]\n");
   }
 
   cleanup_unset_argtable(&args);
@@ -187,7 +205,8 @@ const jshell_cmd_spec_t cmd_unset_spec = {
   .long_help = "Remove the specified environment variables from the shell.",
   .type = CMD_BUILTIN,
   .run = unset_run,
-  .print_usage = unset_print_usage
+  .print_usage = unset_print_usage,
+  .describe_args = unset_describe_args
 };
 
 
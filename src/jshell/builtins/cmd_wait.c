@@ -6,23 +6,30 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/wait.h>
+#include <limits.h>
 #include <errno.h>
 
 #include "argtable3.h"
 #include "jshell/jshell_cmd_registry.h"
+#include "jshell/jshell_io.h"
 #include "jshell/jshell_job_control.h"
 
 
+/** Most job IDs accepted on one command line */
+#define WAIT_MAX_JOB_ARGS 256
+
+
 /**
  * Argument table structure for the wait command
  */
 typedef struct {
   struct arg_lit *help;
   struct arg_lit *json;
+  struct arg_lit *any;
+  struct arg_dbl *timeout;
   struct arg_str *job_id;
   struct arg_end *end;
-  void *argtable[4];
+  void *argtable[6];
 } wait_args_t;
 
 
@@ -34,14 +41,20 @@ typedef struct {
 static void build_wait_argtable(wait_args_t *args) {
   args->help = arg_lit0("h", "help", "display this help and exit");
   args->json = arg_lit0(NULL, "json", "output in JSON format");
-  args->job_id = arg_str0(NULL, NULL, "JOB_ID",
-                          "job ID to wait for (use %N or just N)");
+  args->any = arg_lit0("n", "any",
+                       "return when the first of the jobs finishes");
+  args->timeout = arg_dbl0(NULL, "timeout", "SECONDS",
+                           "give up after SECONDS (exit status 124)");
+  args->job_id = arg_strn(NULL, NULL, "JOB_ID", 0, WAIT_MAX_JOB_ARGS,
+                          "job IDs to wait for (use %N or just N)");
   args->end = arg_end(20);
 
   args->argtable[0] = args->help;
   args->argtable[1] = args->json;
-  args->argtable[2] = args->job_id;
-  args->argtable[3] = args->end;
+  args->argtable[2] = args->any;
+  args->argtable[3] = args->timeout;
+  args->argtable[4] = args->job_id;
+  args->argtable[5] = args->end;
 }
 
 
@@ -66,8 +79,10 @@ static void wait_print_usage(FILE *out) {
   build_wait_argtable(&args);
   fprintf(out, "Usage: wait");
   arg_print_syntax(out, args.argtable, "\n");
-  fprintf(out, "Wait for a job to finish.\n\n");
-  fprintf(out, "If no JOB_ID is specified, waits for all background jobs.\n\n");
+  fprintf(out, "Wait for jobs to finish.\n\n");
+  fprintf(out, "If no JOB_ID is specified, waits for all background jobs.\n");
+  fprintf(out, "With -n, returns as soon as one of the jobs finishes and\n");
+  fprintf(out, "exits with its status; the others keep running.\n\n");
   fprintf(out, "Options:\n");
   arg_print_glossary(out, args.argtable, "  %-20s %s\n");
   cleanup_wait_argtable(&args);
@@ -75,47 +90,167 @@ static void wait_print_usage(FILE *out) {
 
 
 /**
- * Context structure for waiting on all jobs
+ * Passes the wait argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void wait_describe_args(jshell_argtable_visit_fn visit, void *userdata) {
+  wait_args_t args;
+  build_wait_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_wait_argtable(&args);
+}
+
+
+/**
+ * List of job IDs to wait for
  */
 typedef struct {
-  int show_json;
-  int first;
-  int total_status;
-} wait_all_ctx_t;
+  int *ids;
+  size_t count;
+  size_t capacity;
+} wait_job_list_t;
 
 
 /**
- * Callback function to wait for each job.
+ * Callback collecting the IDs of all active jobs.
  *
- * @param job Background job to wait for
- * @param userdata Pointer to wait_all_ctx_t context
+ * @param job Background job
+ * @param userdata Pointer to wait_job_list_t
  */
-static void wait_for_job_callback(const BackgroundJob *job, void *userdata) {
-  wait_all_ctx_t *ctx = (wait_all_ctx_t *)userdata;
+static void collect_job_callback(const BackgroundJob *job, void *userdata) {
+  wait_job_list_t *list = (wait_job_list_t *)userdata;
+
+  if (list->count == list->capacity) {
+    size_t capacity = list->capacity ? list->capacity * 2 : 16;
+    int *grown = realloc(list->ids, capacity * sizeof(int));
+    if (grown == NULL) {
+      return;
+    }
+    list->ids = grown;
+    list->capacity = capacity;
+  }
+  list->ids[list->count++] = job->job_id;
+}
 
-  int status = jshell_wait_for_job(job->job_id);
 
-  if (status == -2) {
-    /* Interrupted by signal - mark context and return */
-    ctx->total_status = 130;  /* 128 + SIGINT(2) */
-    return;
+/**
+ * Reports a job specification error.
+ *
+ * @param show_json Whether to print JSON
+ * @param message Message prefix
+ * @param job_str Offending job specification
+ */
+static void wait_report_error(int show_json, const char *message,
+                              const char *job_str) {
+  if (show_json) {
+    jshell_printf("{\"status\": \"error\", \"message\": \"%s: %s\"}\n",
+                  message, job_str);
+  } else {
+    fprintf(stderr, "wait: %s: %s\n", message, job_str);
   }
+}
+
+
+/**
+ * Parses the job IDs given on the command line.
+ *
+ * @param args Parsed arguments
+ * @param show_json Whether errors are printed as JSON
+ * @param list List to fill
+ * @return 0 on success, or the exit status for an invalid or unknown job
+ */
+static int parse_job_ids(const wait_args_t *args, int show_json,
+                         wait_job_list_t *list) {
+  list->ids = calloc((size_t)args->job_id->count, sizeof(int));
+  if (list->ids == NULL) {
+    fprintf(stderr, "wait: out of memory\n");
+    return 1;
+  }
+  list->capacity = (size_t)args->job_id->count;
 
-  if (ctx->show_json) {
-    if (!ctx->first) {
-      printf(",\n");
+  for (int i = 0; i < args->job_id->count; i++) {
+    const char *job_str = args->job_id->sval[i];
+    const char *num_start = job_str[0] == '%' ? job_str + 1 : job_str;
+
+    char *endptr;
+    long job_id = strtol(num_start, &endptr, 10);
+    if (*endptr != '\0' || job_id <= 0 || job_id > INT_MAX) {
+      wait_report_error(show_json, "invalid job specification", job_str);
+      return 1;
+    }
+    if (jshell_find_job_by_id((int)job_id) == NULL) {
+      wait_report_error(show_json, "no such job", num_start);
+      return 127;
     }
-    ctx->first = 0;
-    printf("    {\"job\": %d, \"status\": \"exited\", \"code\": %d}",
-           job->job_id, status);
+    list->ids[list->count++] = (int)job_id;
   }
+  return 0;
+}
+
 
-  if (status != 0) {
-    ctx->total_status = status;
+/**
+ * Returns the JSON name of a wait result.
+ *
+ * @param result Result of the wait
+ * @return Status string
+ */
+static const char *wait_result_string(JobWaitResult result) {
+  switch (result) {
+    case JOB_WAIT_DONE:        return "ok";
+    case JOB_WAIT_TIMEOUT:     return "timeout";
+    case JOB_WAIT_INTERRUPTED: return "interrupted";
+    default:                   return "error";
   }
 }
 
 
+/**
+ * Prints the outcome of a wait in JSON.
+ *
+ * A single job ID or -n prints one job object; otherwise every selected
+ * job is listed, with the ones still running marked as such.
+ *
+ * @param list Waited-for jobs
+ * @param statuses Exit status of each collected job, -1 for the others
+ * @param single Whether to print a single job object
+ * @param result Result of the wait
+ */
+static void print_wait_json(const wait_job_list_t *list, const int *statuses,
+                            int single, JobWaitResult result) {
+  if (single) {
+    for (size_t i = 0; i < list->count; i++) {
+      if (statuses[i] >= 0) {
+        jshell_printf("{\"job\": %d, \"status\": \"exited\", \"code\": %d}\n",
+                      list->ids[i], statuses[i]);
+        return;
+      }
+    }
+    if (list->count == 1) {
+      jshell_printf("{\"job\": %d, \"status\": \"%s\"}\n", list->ids[0],
+                    wait_result_string(result));
+    } else {
+      jshell_printf("{\"status\": \"%s\"}\n", wait_result_string(result));
+    }
+    return;
+  }
+
+  jshell_printf("{\"jobs\": [");
+  for (size_t i = 0; i < list->count; i++) {
+    jshell_printf("%s\n    ", i == 0 ? "" : ",");
+    if (statuses[i] >= 0) {
+      jshell_printf("{\"job\": %d, \"status\": \"exited\", \"code\": %d}",
+                    list->ids[i], statuses[i]);
+    } else {
+      jshell_printf("{\"job\": %d, \"status\": \"running\"}", list->ids[i]);
+    }
+  }
+  jshell_printf("%s],\n  \"status\": \"%s\"\n}\n",
+                list->count > 0 ? "\n  " : "", wait_result_string(result));
+}
+
+
 /**
  * Executes the wait command.
  *
@@ -130,7 +265,7 @@ static int wait_run(int argc, char **argv) {
   int nerrors = arg_parse(argc, argv, args.argtable);
 
   if (args.help->count > 0) {
-    wait_print_usage(stdout);
+    wait_print_usage(jshell_io_stdout());
     cleanup_wait_argtable(&args);
     return 0;
   }
@@ -143,87 +278,71 @@ static int wait_run(int argc, char **argv) {
   }
 
   int show_json = args.json->count > 0;
-
-  if (args.job_id->count == 0) {
-    if (jshell_get_job_count() == 0) {
-      if (show_json) {
-        printf("{\"jobs\": [], \"status\": \"ok\"}\n");
-      }
+  int any = args.any->count > 0;
+  int timeout_ms = -1;
+  if (args.timeout->count > 0) {
+    double seconds = args.timeout->dval[0];
+    if (!(seconds >= 0) || seconds > INT_MAX / 1000) {
+      fprintf(stderr, "wait: invalid timeout: %g\n", seconds);
       cleanup_wait_argtable(&args);
-      return 0;
+      return 1;
     }
-
-    wait_all_ctx_t ctx = {
-      .show_json = show_json,
-      .first = 1,
-      .total_status = 0
-    };
-
-    if (show_json) {
-      printf("{\"jobs\": [\n");
-    }
-
-    jshell_for_each_job(wait_for_job_callback, &ctx);
-
-    if (show_json) {
-      printf("\n  ],\n  \"status\": \"ok\"\n}\n");
-    }
-
-    cleanup_wait_argtable(&args);
-    return ctx.total_status;
+    timeout_ms = (int)(seconds * 1000);
   }
 
-  const char *job_str = args.job_id->sval[0];
-  const char *num_start = job_str;
-  if (job_str[0] == '%') {
-    num_start = job_str + 1;
+  wait_job_list_t list = {0};
+  int all_jobs = args.job_id->count == 0;
+  if (all_jobs) {
+    jshell_for_each_job(collect_job_callback, &list);
+  } else {
+    int err = parse_job_ids(&args, show_json, &list);
+    if (err != 0) {
+      free(list.ids);
+      cleanup_wait_argtable(&args);
+      return err;
+    }
   }
 
-  char *endptr;
-  long job_id = strtol(num_start, &endptr, 10);
-  if (*endptr != '\0' || job_id <= 0) {
-    if (show_json) {
-      printf("{\"status\": \"error\", "
-             "\"message\": \"invalid job specification: %s\"}\n", job_str);
-    } else {
-      fprintf(stderr, "wait: invalid job specification: %s\n", job_str);
-    }
+  int *statuses = calloc(list.count ? list.count : 1, sizeof(int));
+  if (statuses == NULL) {
+    fprintf(stderr, "wait: out of memory\n");
+    free(list.ids);
     cleanup_wait_argtable(&args);
     return 1;
   }
 
-  BackgroundJob *job = jshell_find_job_by_id((int)job_id);
-  if (job == NULL) {
-    if (show_json) {
-      printf("{\"status\": \"error\", \"message\": \"no such job: %ld\"}\n",
-             job_id);
-    } else {
-      fprintf(stderr, "wait: no such job: %ld\n", job_id);
-    }
-    cleanup_wait_argtable(&args);
-    return 127;
-  }
+  JobWaitResult result = jshell_wait_for_job_set(list.ids, list.count, any,
+                                                 timeout_ms, statuses);
 
-  int status = jshell_wait_for_job((int)job_id);
+  if (show_json) {
+    print_wait_json(&list, statuses, any || (list.count == 1 && !all_jobs),
+                    result);
+  } else if (result == JOB_WAIT_INTERRUPTED) {
+    fprintf(stderr, "wait: interrupted\n");
+  } else if (result == JOB_WAIT_ERROR) {
+    fprintf(stderr, "wait: %s\n", strerror(errno));
+  }
 
-  if (status == -2) {
-    /* Interrupted by signal */
-    if (show_json) {
-      printf("{\"job\": %ld, \"status\": \"interrupted\"}\n", job_id);
-    } else {
-      fprintf(stderr, "wait: interrupted\n");
+  /* -n and explicit IDs give the status of the job (the last one listed);
+   * waiting for all jobs gives the last non-zero status */
+  int exit_status = 0;
+  for (size_t i = 0; i < list.count; i++) {
+    if (statuses[i] >= 0 && (!all_jobs || any || statuses[i] != 0)) {
+      exit_status = statuses[i];
     }
-    cleanup_wait_argtable(&args);
-    return 130;  /* 128 + SIGINT(2) */
   }
-
-  if (show_json) {
-    printf("{\"job\": %ld, \"status\": \"exited\", \"code\": %d}\n",
-           job_id, status);
+  if (result == JOB_WAIT_TIMEOUT) {
+    exit_status = 124;
+  } else if (result == JOB_WAIT_INTERRUPTED) {
+    exit_status = 130;  /* 128 + SIGINT(2) */
+  } else if (result == JOB_WAIT_ERROR) {
+    exit_status = 1;
   }
 
+  free(statuses);
+  free(list.ids);
   cleanup_wait_argtable(&args);
-  return status;
+  return exit_status;
 }
 
 
@@ -232,12 +351,14 @@ static int wait_run(int argc, char **argv) {
  */
 const jshell_cmd_spec_t cmd_wait_spec = {
   .name = "wait",
-  .summary = "wait for a job to finish",
-  .long_help = "Wait for a background job to finish and return its exit status.\n"
-               "If no job ID is specified, waits for all background jobs.",
+  .summary = "wait for jobs to finish",
+  .long_help = "Wait for background jobs to finish and return the exit status\n"
+               "of the last one. If no job ID is specified, waits for all\n"
+               "background jobs; with -n, for the first of them to finish.",
   .type = CMD_BUILTIN,
   .run = wait_run,
-  .print_usage = wait_print_usage
+  .print_usage = wait_print_usage,
+  .describe_args = wait_describe_args
 };
 
 
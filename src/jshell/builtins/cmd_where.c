@@ -0,0 +1,316 @@
+/**
+ * @file cmd_where.c
+ * @brief Filter structured records builtin command implementation
+ *
+ * Reads objects from stdin, one per NDJSON line or as binary records from
+ * an in-process stage such as `ls --json-stream`, and passes on those
+ * whose field matches a condition. Records go on as records when the next
+ * stage reads them too, and as NDJSON otherwise.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include "argtable3.h"
+#include "jshell/jshell_cmd_registry.h"
+#include "jshell/jshell_io.h"
+#include "jshell/jshell_signals.h"
+#include "utils/jbox_record.h"
+
+
+/**
+ * Comparisons a condition can make.
+ */
+typedef enum {
+  WHERE_EQ,
+  WHERE_NE,
+  WHERE_CONTAINS,
+  WHERE_LT,
+  WHERE_LE,
+  WHERE_GT,
+  WHERE_GE,
+} where_op_t;
+
+
+/**
+ * A parsed condition: FIELD OP VALUE.
+ */
+typedef struct {
+  const char *field;
+  where_op_t op;
+  const char *value;
+  long long number;     /* VALUE as an integer, for numeric operators */
+} where_cond_t;
+
+
+/**
+ * Operator words and the comparison they stand for.
+ */
+static const struct {
+  const char *word;
+  where_op_t op;
+} WHERE_OPS[] = {
+  { "eq", WHERE_EQ },
+  { "ne", WHERE_NE },
+  { "has", WHERE_CONTAINS },
+  { "lt", WHERE_LT },
+  { "le", WHERE_LE },
+  { "gt", WHERE_GT },
+  { "ge", WHERE_GE },
+};
+
+
+/**
+ * Arguments structure for the where command.
+ */
+typedef struct {
+  struct arg_lit *help;
+  struct arg_str *cond;
+  struct arg_end *end;
+  void *argtable[3];
+} where_args_t;
+
+
+/**
+ * Builds the argtable3 structure for the where command.
+ *
+ * @param args Pointer to where_args_t structure to populate
+ */
+static void build_where_argtable(where_args_t *args) {
+  args->help = arg_lit0("h", "help", "display this help and exit");
+  args->cond = arg_strn(NULL, NULL, "FIELD OP VALUE", 3, 3,
+                        "condition a record must meet");
+  args->end  = arg_end(20);
+
+  args->argtable[0] = args->help;
+  args->argtable[1] = args->cond;
+  args->argtable[2] = args->end;
+}
+
+
+/**
+ * Frees memory allocated for the where argtable.
+ *
+ * @param args Pointer to where_args_t structure to cleanup
+ */
+static void cleanup_where_argtable(where_args_t *args) {
+  arg_freetable(args->argtable,
+                sizeof(args->argtable) / sizeof(args->argtable[0]));
+}
+
+
+/**
+ * Prints usage information for the where command.
+ *
+ * @param out Output stream to write usage information to
+ */
+static void where_print_usage(FILE *out) {
+  where_args_t args;
+  build_where_argtable(&args);
+  fprintf(out, "Usage: where");
+  arg_print_syntax(out, args.argtable, "\n");
+  fprintf(out, "Pass on the JSON objects from stdin whose FIELD meets the "
+               "condition.\n\n");
+  fprintf(out, "Input is NDJSON, e.g. from --json-stream; objects go out "
+               "the same way.\n");
+  fprintf(out, "OP is one of:\n");
+  fprintf(out, "  eq ne              FIELD equals / differs from VALUE\n");
+  fprintf(out, "  has                FIELD contains VALUE\n");
+  fprintf(out, "  lt le gt ge        FIELD is an integer <, <=, >, >= "
+               "VALUE\n\n");
+  fprintf(out, "Options:\n");
+  arg_print_glossary(out, args.argtable, "  %-20s %s\n");
+  cleanup_where_argtable(&args);
+}
+
+
+/**
+ * Passes the where argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void where_describe_args(jshell_argtable_visit_fn visit,
+                                void *userdata) {
+  where_args_t args;
+  build_where_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_where_argtable(&args);
+}
+
+
+/**
+ * Parses the condition words.
+ *
+ * @param words FIELD, OP and VALUE
+ * @param cond Set to the condition
+ * @return 0 on success, -1 (after reporting) on a bad operator or value
+ */
+static int parse_condition(const char **words, where_cond_t *cond) {
+  cond->field = words[0];
+  cond->value = words[2];
+
+  size_t op_count = sizeof(WHERE_OPS) / sizeof(WHERE_OPS[0]);
+  size_t i = 0;
+  while (i < op_count && strcmp(WHERE_OPS[i].word, words[1]) != 0) {
+    i++;
+  }
+  if (i == op_count) {
+    fprintf(stderr, "where: unknown operator '%s'\n", words[1]);
+    return -1;
+  }
+  cond->op = WHERE_OPS[i].op;
+
+  if (cond->op >= WHERE_LT) {
+    char *end;
+    errno = 0;
+    cond->number = strtoll(cond->value, &end, 10);
+    if (errno != 0 || end == cond->value || *end != '\0') {
+      fprintf(stderr, "where: '%s' is not an integer\n", cond->value);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+
+/**
+ * Tells whether a record meets the condition.
+ *
+ * Equality and containment compare the field as it would be printed
+ * in JSON, without the quotes of a string; a record without the field
+ * never matches.
+ *
+ * @param rec Record
+ * @param cond Condition
+ * @return true if the record matches
+ */
+static bool record_matches(const jbox_record_t *rec,
+                           const where_cond_t *cond) {
+  jbox_field_t field;
+  if (!jbox_record_find(rec, cond->field, &field)) {
+    return false;
+  }
+
+  if (cond->op >= WHERE_LT) {
+    if (field.type != JBOX_FIELD_INT) {
+      return false;
+    }
+    switch (cond->op) {
+      case WHERE_LT: return field.num < cond->number;
+      case WHERE_LE: return field.num <= cond->number;
+      case WHERE_GT: return field.num > cond->number;
+      default:       return field.num >= cond->number;
+    }
+  }
+
+  char number[32];
+  const char *text = field.str;
+  if (field.type == JBOX_FIELD_INT) {
+    snprintf(number, sizeof(number), "%lld", field.num);
+    text = number;
+  } else if (field.type == JBOX_FIELD_BOOL) {
+    text = field.num ? "true" : "false";
+  } else if (field.type == JBOX_FIELD_NULL) {
+    text = "null";
+  }
+
+  switch (cond->op) {
+    case WHERE_EQ: return strcmp(text, cond->value) == 0;
+    case WHERE_NE: return strcmp(text, cond->value) != 0;
+    default:       return strstr(text, cond->value) != NULL;
+  }
+}
+
+
+/**
+ * Executes the where command.
+ *
+ * @param argc Number of arguments
+ * @param argv Array of argument strings
+ * @return 0 on success, 1 if input was malformed or arguments are bad
+ */
+static int where_run(int argc, char **argv) {
+  where_args_t args;
+  build_where_argtable(&args);
+
+  int nerrors = arg_parse(argc, argv, args.argtable);
+
+  if (args.help->count > 0) {
+    where_print_usage(jshell_io_stdout());
+    cleanup_where_argtable(&args);
+    return 0;
+  }
+
+  if (nerrors > 0) {
+    arg_print_errors(stderr, args.end, "where");
+    fprintf(stderr, "Try 'where --help' for more information.\n");
+    cleanup_where_argtable(&args);
+    return 1;
+  }
+
+  where_cond_t cond;
+  if (parse_condition(args.cond->sval, &cond) != 0) {
+    cleanup_where_argtable(&args);
+    return 1;
+  }
+
+  FILE *in = jshell_io_stdin();
+  FILE *out = jshell_io_stdout();
+  bool binary = jshell_io_records_out();
+  jbox_record_t rec;
+  jbox_record_init(&rec);
+  int status = 0;
+  int rc;
+
+  while ((rc = jbox_record_read(in, &rec)) != 0) {
+    if (jshell_is_interrupted()) {
+      status = 1;
+      break;
+    }
+    if (rc < 0) {
+      if (status == 0) {
+        fprintf(stderr, "where: input is not a JSON object per line\n");
+      }
+      status = 1;
+      continue;
+    }
+    if (record_matches(&rec, &cond)
+        && jbox_record_write(out, &rec, binary) != 0) {
+      status = 1;
+      break;
+    }
+  }
+
+  jbox_record_free(&rec);
+  cleanup_where_argtable(&args);
+  return status;
+}
+
+
+/**
+ * Command specification for the where builtin.
+ */
+const jshell_cmd_spec_t cmd_where_spec = {
+  .name = "where",
+  .summary = "filter JSON records by a field",
+  .long_help = "Read JSON objects from stdin, one per line, and pass on "
+               "those whose FIELD meets the condition. Reads the records "
+               "of in-process --json-stream stages without parsing text.",
+  .type = CMD_BUILTIN,
+  .run = where_run,
+  .print_usage = where_print_usage,
+  .describe_args = where_describe_args,
+  .reads_records = true
+};
+
+
+/**
+ * Registers the where command with the shell command registry.
+ */
+void jshell_register_where_command(void) {
+  jshell_register_command(&cmd_where_spec);
+}
@@ -0,0 +1,12 @@
+#ifndef CMD_WHERE_H
+#define CMD_WHERE_H
+
+#include "jshell/jshell_cmd_registry.h"
+
+
+extern const jshell_cmd_spec_t cmd_where_spec;
+
+void jshell_register_where_command(void);
+
+
+#endif
@@ -0,0 +1,830 @@
+/**
+ * @file cmd_xargs.c
+ * @brief Implementation of the xargs builtin for running a command over
+ *        batches of input items
+ *
+ * Items are read from standard input, one per line (or NUL-separated with
+ * -0), and appended to the command in batches as large as the system's
+ * argument size limit allows, so thousands of items cost a handful of
+ * runs. Builtins and linked apps run in-process on worker threads,
+ * everything else goes through the spawn fast path. With -P several
+ * batches run at once; output is still printed in batch order, the oldest
+ * batch's as it comes and the others' once their turn arrives.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "argtable3.h"
+#include "jshell/jshell_cmd_registry.h"
+#include "jshell/jshell_io.h"
+#include "jshell/jshell_path.h"
+#include "jshell/jshell_register_externals.h"
+#include "jshell/jshell_signals.h"
+#include "jshell/jshell_spawn.h"
+#include "jshell/jshell_thread_exec.h"
+
+
+extern char **environ;
+
+
+// Upper bound on -P; each running batch holds a pipe and a thread/child
+#define XARGS_MAX_PROCS 256
+
+// Room left in the argument area for what exec adds (as GNU xargs)
+#define XARGS_ARG_HEADROOM 2048
+
+// Status when a batch failed (as GNU xargs)
+#define XARGS_FAILED_STATUS 123
+
+// Bytes read at a time from the oldest batch's output
+#define XARGS_COPY_SIZE 65536
+
+
+/**
+ * Argument table structure for the xargs command
+ */
+typedef struct {
+  struct arg_lit *help;
+  struct arg_lit *null;
+  struct arg_int *max_args;
+  struct arg_int *max_procs;
+  struct arg_int *max_chars;
+  struct arg_str *command;
+  struct arg_end *end;
+  void *argtable[7];
+} xargs_args_t;
+
+
+/**
+ * Where batches come from: the command, the item stream and the limits
+ */
+typedef struct {
+  char **template;
+  int template_count;
+  size_t template_size;
+  FILE *in;
+  int delim;
+  long max_args;        // Items per batch, or 0 for no limit
+  size_t max_size;      // Bytes of argument strings and pointers per batch
+  char *pending;        // Item read but not yet placed in a batch, or NULL
+  char *line;
+  size_t line_cap;
+  bool eof;
+} xargs_source_t;
+
+
+/**
+ * State of one batch
+ */
+typedef struct {
+  pid_t pid;                    // Child process, or -1
+  JShellBuiltinThread *thread;  // Worker thread for in-process commands
+  int output_fd;                // Read end of the capture pipe, or -1
+  char *output;                 // Output held until the batch is oldest
+  size_t output_len;
+  size_t output_cap;
+  int exit_status;
+  bool finished;
+} xargs_batch_t;
+
+
+/**
+ * Builds the argtable3 argument table for the xargs command.
+ *
+ * @param args Pointer to xargs_args_t structure to populate
+ */
+static void build_xargs_argtable(xargs_args_t *args) {
+  args->help = arg_lit0("h", "help", "display this help and exit");
+  args->null = arg_lit0("0", "null", "items are separated by NUL, not "
+                        "newline");
+  args->max_args = arg_int0("n", "max-args", "N",
+                            "pass at most N items per command");
+  args->max_procs = arg_int0("P", "max-procs", "N",
+                             "run at most N commands at once (default: 1)");
+  args->max_chars = arg_int0("s", "max-chars", "SIZE",
+                             "limit each command line to SIZE bytes "
+                             "(default: system limit)");
+  args->command = arg_strn(NULL, NULL, "COMMAND", 0, 1,
+                           "command and its first arguments");
+  args->end = arg_end(20);
+
+  args->argtable[0] = args->help;
+  args->argtable[1] = args->null;
+  args->argtable[2] = args->max_args;
+  args->argtable[3] = args->max_procs;
+  args->argtable[4] = args->max_chars;
+  args->argtable[5] = args->command;
+  args->argtable[6] = args->end;
+}
+
+
+/**
+ * Cleans up the argtable3 argument table for the xargs command.
+ *
+ * @param args Pointer to xargs_args_t structure to free
+ */
+static void cleanup_xargs_argtable(xargs_args_t *args) {
+  arg_freetable(args->argtable,
+                sizeof(args->argtable) / sizeof(args->argtable[0]));
+}
+
+
+/**
+ * Prints usage information for the xargs command.
+ *
+ * @param out Output stream to write to
+ */
+static void xargs_print_usage(FILE *out) {
+  xargs_args_t args;
+  build_xargs_argtable(&args);
+  fprintf(out, "Usage: xargs [-h] [-0] [-n N] [-P N] [-s SIZE] "
+               "[COMMAND [ARG...]]\n");
+  fprintf(out, "Run COMMAND with the items read from standard input "
+               "appended, as few times as possible.\n\n");
+  fprintf(out, "Items are one per line (empty lines are skipped), or\n");
+  fprintf(out, "NUL-separated with -0. The default COMMAND is echo.\n");
+  fprintf(out, "Without input, COMMAND is not run.\n");
+  fprintf(out, "Exit status is %d if a command failed, 126 or 127 if it "
+               "could not be run.\n\n", XARGS_FAILED_STATUS);
+  fprintf(out, "Options:\n");
+  arg_print_glossary(out, args.argtable, "  %-20s %s\n");
+  cleanup_xargs_argtable(&args);
+}
+
+
+/**
+ * Passes the xargs argtable to visit, for tool schemas derived from it.
+ *
+ * @param visit Receives the table while it is built
+ * @param userdata Passed through to visit
+ */
+static void xargs_describe_args(jshell_argtable_visit_fn visit,
+                                void *userdata) {
+  xargs_args_t args;
+  build_xargs_argtable(&args);
+  visit(args.argtable, userdata);
+  cleanup_xargs_argtable(&args);
+}
+
+
+/**
+ * Finds where the options end and the command begins.
+ *
+ * Options are only recognised before the command, so the command's own
+ * flags (e.g. "rg -n") are passed through untouched.
+ *
+ * @param argc Argument count
+ * @param argv Argument vector
+ * @param skip_separator Set to true if the command is preceded by "--"
+ * @return Index of the first option-free argument
+ */
+static int find_command_start(int argc, char **argv, bool *skip_separator) {
+  *skip_separator = false;
+
+  int i = 1;
+  while (i < argc) {
+    const char *arg = argv[i];
+    if (strcmp(arg, "--") == 0) {
+      *skip_separator = true;
+      return i;
+    }
+    if (arg[0] != '-' || arg[1] == '\0') {
+      return i;
+    }
+    if (strcmp(arg, "-n") == 0 || strcmp(arg, "--max-args") == 0
+        || strcmp(arg, "-P") == 0 || strcmp(arg, "--max-procs") == 0
+        || strcmp(arg, "-s") == 0 || strcmp(arg, "--max-chars") == 0) {
+      i += 2;
+    } else {
+      i++;
+    }
+  }
+
+  return argc < i ? argc : i;
+}
+
+
+/**
+ * Computes the default batch size: what exec accepts, less the
+ * environment the command inherits and some headroom.
+ *
+ * @return Bytes of argument strings and pointers a batch may hold
+ */
+static size_t default_max_size(void) {
+  long arg_max = sysconf(_SC_ARG_MAX);
+  if (arg_max <= 0) {
+    arg_max = _POSIX_ARG_MAX;
+  }
+
+  size_t env_size = 0;
+  for (char **env = environ; env != NULL && *env != NULL; env++) {
+    env_size += strlen(*env) + 1 + sizeof(char *);
+  }
+
+  size_t limit = (size_t)arg_max;
+  if (limit < env_size + XARGS_ARG_HEADROOM + _POSIX_ARG_MAX / 2) {
+    return _POSIX_ARG_MAX / 2;
+  }
+  return limit - env_size - XARGS_ARG_HEADROOM;
+}
+
+
+/**
+ * Bytes an argument takes in the argument area.
+ *
+ * @param arg Argument
+ * @return Its length with terminator, plus its pointer
+ */
+static size_t arg_size(const char *arg) {
+  return strlen(arg) + 1 + sizeof(char *);
+}
+
+
+/**
+ * Reads the next non-empty item.
+ *
+ * @param src Batch source
+ * @return Allocated item, or NULL at the end of input
+ */
+static char *read_item(xargs_source_t *src) {
+  if (src->pending != NULL) {
+    char *item = src->pending;
+    src->pending = NULL;
+    return item;
+  }
+
+  while (!src->eof) {
+    ssize_t len = getdelim(&src->line, &src->line_cap, src->delim, src->in);
+    if (len == -1) {
+      src->eof = true;
+      break;
+    }
+    if (len > 0 && src->line[len - 1] == src->delim) {
+      src->line[--len] = '\0';
+    }
+    if (len > 0) {
+      char *item = strdup(src->line);
+      if (item == NULL) {
+        perror("xargs: strdup");
+        src->eof = true;
+      }
+      return item;
+    }
+  }
+  return NULL;
+}
+
+
+/**
+ * Frees an argument vector built by next_batch.
+ *
+ * @param argv NULL-terminated argument vector
+ * @param template_count Number of leading words borrowed from the template
+ */
+static void free_batch_argv(char **argv, int template_count) {
+  if (argv == NULL) {
+    return;
+  }
+  for (size_t i = (size_t)template_count; argv[i] != NULL; i++) {
+    free(argv[i]);
+  }
+  free(argv);
+}
+
+
+/**
+ * Builds the argument vector of the next batch: the template, then as
+ * many items as the limits allow (always at least one).
+ *
+ * @param src Batch source
+ * @param argc_out Set to the argument count
+ * @return Allocated NULL-terminated argument vector whose first
+ *         template_count words are borrowed, or NULL once the input is
+ *         exhausted or memory ran out
+ */
+static char **next_batch(xargs_source_t *src, int *argc_out) {
+  char *item = read_item(src);
+  if (item == NULL) {
+    return NULL;
+  }
+
+  size_t cap = 64;
+  char **argv = malloc(cap * sizeof(char *));
+  if (argv == NULL) {
+    perror("xargs: malloc");
+    free(item);
+    return NULL;
+  }
+  memcpy(argv, src->template, (size_t)src->template_count * sizeof(char *));
+  int argc = src->template_count;
+  size_t size = src->template_size;
+  long items = 0;
+
+  while (item != NULL) {
+    size_t item_size = arg_size(item);
+    if (items > 0 && ((src->max_args > 0 && items >= src->max_args)
+                      || size + item_size > src->max_size)) {
+      src->pending = item;
+      break;
+    }
+    if ((size_t)argc + 2 > cap) {
+      cap *= 2;
+      char **grown = realloc(argv, cap * sizeof(char *));
+      if (grown == NULL) {
+        perror("xargs: realloc");
+        free(item);
+        break;
+      }
+      argv = grown;
+    }
+    argv[argc++] = item;
+    size += item_size;
+    items++;
+    item = read_item(src);
+  }
+
+  argv[argc] = NULL;
+  *argc_out = argc;
+  return argv;
+}
+
+
+/**
+ * Starts one batch.
+ *
+ * With stream set, an in-process command writes straight to the output
+ * stream and the batch is finished on return; otherwise its output goes
+ * to a fresh capture pipe. Commands read from /dev/null so they do not
+ * take the items meant for later batches.
+ *
+ * @param batch Batch to start
+ * @param spec Command's spec, or NULL for a program on PATH
+ * @param exec_path Resolved program path for spawned commands
+ * @param stream Stream for in-process output, or NULL to capture it
+ * @param argc Argument count
+ * @param argv Argument vector
+ */
+static void start_batch(xargs_batch_t *batch, const jshell_cmd_spec_t *spec,
+                        const char *exec_path, FILE *stream, int argc,
+                        char **argv) {
+  int input_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  if (input_fd == -1) {
+    perror("xargs: /dev/null");
+    batch->exit_status = 1;
+    batch->finished = true;
+    return;
+  }
+
+  if (stream != NULL) {
+    JShellStageIO io = {
+      .input_fd = input_fd,
+      .output_fd = -1,
+      .output_stream = stream,
+    };
+    JShellBuiltinThread *thread = jshell_spawn_builtin_stage(spec, argc,
+                                                             argv, &io);
+    if (thread == NULL) {
+      close(input_fd);
+      batch->exit_status = 1;
+    } else {
+      batch->exit_status = jshell_wait_builtin_thread(thread);
+      jshell_free_builtin_thread(thread);
+    }
+    batch->finished = true;
+    return;
+  }
+
+  int pipe_fds[2];
+  if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+    perror("xargs: pipe");
+    close(input_fd);
+    batch->exit_status = 1;
+    batch->finished = true;
+    return;
+  }
+
+  if (spec != NULL) {
+    batch->thread = jshell_spawn_builtin_thread(spec, argc, argv,
+                                                input_fd, pipe_fds[1]);
+    if (batch->thread == NULL) {
+      close(input_fd);
+      close(pipe_fds[0]);
+      close(pipe_fds[1]);
+      batch->exit_status = 1;
+      batch->finished = true;
+      return;
+    }
+    batch->output_fd = pipe_fds[0];
+    return;
+  }
+
+  int failure_status = 0;
+  batch->pid = jshell_spawn_command(exec_path, argv, input_fd, pipe_fds[1],
+                                    NULL, 0, &failure_status);
+  close(input_fd);
+  close(pipe_fds[1]);
+
+  if (batch->pid == -1) {
+    close(pipe_fds[0]);
+    batch->exit_status = failure_status;
+    batch->finished = true;
+    return;
+  }
+  batch->output_fd = pipe_fds[0];
+}
+
+
+/**
+ * Collects the exit status of a batch whose output reached EOF.
+ *
+ * @param batch Batch to finish
+ */
+static void finish_batch(xargs_batch_t *batch) {
+  if (batch->thread != NULL) {
+    batch->exit_status = jshell_wait_builtin_thread(batch->thread);
+    jshell_free_builtin_thread(batch->thread);
+    batch->thread = NULL;
+  } else if (batch->pid > 0) {
+    int status;
+    pid_t rc;
+    do {
+      rc = waitpid(batch->pid, &status, 0);
+    } while (rc == -1 && errno == EINTR);
+
+    if (rc == -1) {
+      perror("xargs: waitpid");
+      batch->exit_status = 1;
+    } else if (WIFEXITED(status)) {
+      batch->exit_status = WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+      batch->exit_status = 128 + WTERMSIG(status);
+    }
+    batch->pid = -1;
+  }
+  batch->finished = true;
+}
+
+
+/**
+ * Reads available output of a batch: the oldest batch's goes straight
+ * to the output stream, a later one's into its buffer.
+ *
+ * @param batch Batch with a readable capture pipe
+ * @param oldest true if every earlier batch has been printed
+ * @return true once the pipe has reached EOF (and has been closed)
+ */
+static bool drain_batch_output(xargs_batch_t *batch, bool oldest) {
+  char chunk[XARGS_COPY_SIZE];
+  char *dst = chunk;
+  size_t room = sizeof(chunk);
+
+  if (!oldest) {
+    if (batch->output_cap - batch->output_len < 4096) {
+      size_t cap = batch->output_cap == 0 ? 8192 : batch->output_cap * 2;
+      char *grown = realloc(batch->output, cap);
+      if (grown == NULL) {
+        perror("xargs: realloc");
+        close(batch->output_fd);
+        batch->output_fd = -1;
+        return true;
+      }
+      batch->output = grown;
+      batch->output_cap = cap;
+    }
+    dst = batch->output + batch->output_len;
+    room = batch->output_cap - batch->output_len;
+  }
+
+  ssize_t n = read(batch->output_fd, dst, room);
+  if (n > 0) {
+    if (oldest) {
+      fwrite(chunk, 1, (size_t)n, jshell_io_stdout());
+    } else {
+      batch->output_len += (size_t)n;
+    }
+    return false;
+  }
+  if (n == -1 && (errno == EINTR || errno == EAGAIN)) {
+    return false;
+  }
+
+  close(batch->output_fd);
+  batch->output_fd = -1;
+  return true;
+}
+
+
+/**
+ * Maps a batch's exit status to its effect on the xargs status.
+ *
+ * @param status Exit status of the batch
+ * @param result xargs status so far, updated
+ * @return true if no more batches should start (the command cannot run)
+ */
+static bool account_batch(int status, int *result) {
+  if (status == 126 || status == 127) {
+    *result = status;
+    return true;
+  }
+  if (status != 0 && *result == 0) {
+    *result = XARGS_FAILED_STATUS;
+  }
+  return false;
+}
+
+
+/**
+ * Runs every batch with at most max_procs in flight, printing in order.
+ *
+ * Stops starting batches on SIGINT or once the command cannot be run, but
+ * still collects the running ones.
+ *
+ * @param src Batch source
+ * @param spec Command's spec, or NULL for a program on PATH
+ * @param exec_path Resolved program path for spawned commands
+ * @param stream Stream in-process batches write to directly, or NULL
+ * @param max_procs Concurrency limit
+ * @param interrupted Set to true if SIGINT stopped the run early
+ * @return Exit status of the run
+ */
+static int run_batches(xargs_source_t *src, const jshell_cmd_spec_t *spec,
+                       const char *exec_path, FILE *stream, int max_procs,
+                       bool *interrupted) {
+  xargs_batch_t *batches = calloc((size_t)max_procs, sizeof(xargs_batch_t));
+  struct pollfd *pfds = malloc((size_t)max_procs * sizeof(struct pollfd));
+  size_t *pfd_batches = malloc((size_t)max_procs * sizeof(size_t));
+  if (batches == NULL || pfds == NULL || pfd_batches == NULL) {
+    perror("xargs: malloc");
+    free(batches);
+    free(pfds);
+    free(pfd_batches);
+    return 1;
+  }
+
+  // Batch number n lives in slot n % max_procs while it is in flight
+  size_t launched = 0;
+  size_t emitted = 0;
+  int running = 0;
+  int result = 0;
+  bool stop = false;
+  FILE *out = jshell_io_stdout();
+
+  /* A background job is stopped by `kill`, which only sets a flag, so
+   * look at it every so often and stop the workers ourselves */
+  bool background = jshell_get_thread_cancel_flag() != NULL;
+
+  for (;;) {
+    if (jshell_is_interrupted()) {
+      *interrupted = true;
+      stop = true;
+      if (background) {
+        break;
+      }
+    }
+
+    while (!stop && launched - emitted < (size_t)max_procs) {
+      int argc = 0;
+      char **argv = next_batch(src, &argc);
+      if (argv == NULL) {
+        stop = true;
+        break;
+      }
+      xargs_batch_t *batch = &batches[launched++ % (size_t)max_procs];
+      *batch = (xargs_batch_t){ .pid = -1, .output_fd = -1 };
+      start_batch(batch, spec, exec_path, stream, argc, argv);
+      free_batch_argv(argv, src->template_count);
+      if (!batch->finished) {
+        running++;
+      }
+    }
+
+    while (emitted < launched) {
+      xargs_batch_t *batch = &batches[emitted % (size_t)max_procs];
+      if (batch->output_len > 0) {
+        fwrite(batch->output, 1, batch->output_len, out);
+        batch->output_len = 0;
+      }
+      if (!batch->finished) {
+        break;
+      }
+      free(batch->output);
+      batch->output = NULL;
+      batch->output_cap = 0;
+      if (account_batch(batch->exit_status, &result)) {
+        stop = true;
+      }
+      emitted++;
+    }
+
+    if (running == 0) {
+      if (stop) {
+        break;
+      }
+      continue;
+    }
+
+    nfds_t nfds = 0;
+    for (size_t i = emitted; i < launched; i++) {
+      xargs_batch_t *batch = &batches[i % (size_t)max_procs];
+      if (batch->output_fd != -1) {
+        pfds[nfds].fd = batch->output_fd;
+        pfds[nfds].events = POLLIN;
+        pfds[nfds].revents = 0;
+        pfd_batches[nfds] = i;
+        nfds++;
+      }
+    }
+
+    if (poll(pfds, nfds, background ? 100 : -1) == -1) {
+      if (errno != EINTR) {
+        perror("xargs: poll");
+        result = 1;
+        break;
+      }
+      continue;
+    }
+
+    for (nfds_t i = 0; i < nfds; i++) {
+      if (pfds[i].revents == 0) {
+        continue;
+      }
+      xargs_batch_t *batch = &batches[pfd_batches[i] % (size_t)max_procs];
+      if (drain_batch_output(batch, pfd_batches[i] == emitted)) {
+        finish_batch(batch);
+        running--;
+      }
+    }
+  }
+
+  // Only reached with batches in flight on a poll failure or a killed
+  // background job; don't leave workers behind
+  for (size_t i = emitted; i < launched; i++) {
+    xargs_batch_t *batch = &batches[i % (size_t)max_procs];
+    if (batch->output_fd != -1) {
+      close(batch->output_fd);
+      batch->output_fd = -1;
+    }
+    if (batch->pid > 0) {
+      kill(batch->pid, SIGTERM);
+    }
+    if (!batch->finished) {
+      finish_batch(batch);
+    }
+    free(batch->output);
+  }
+
+  free(batches);
+  free(pfds);
+  free(pfd_batches);
+  return result;
+}
+
+
+/**
+ * Executes the xargs command.
+ *
+ * @param argc Argument count
+ * @param argv Argument vector
+ * @return 0 on success, 123 if a command failed, 126/127 if it could not
+ *         be run, 130 if interrupted, or 1 on usage errors
+ */
+static int xargs_run(int argc, char **argv) {
+  bool skip_separator;
+  int command_start = find_command_start(argc, argv, &skip_separator);
+
+  xargs_args_t args;
+  build_xargs_argtable(&args);
+
+  int nerrors = arg_parse(command_start, argv, args.argtable);
+
+  if (args.help->count > 0) {
+    xargs_print_usage(jshell_io_stdout());
+    cleanup_xargs_argtable(&args);
+    return 0;
+  }
+
+  if (nerrors > 0) {
+    arg_print_errors(stderr, args.end, "xargs");
+    fprintf(stderr, "Try 'xargs --help' for more information.\n");
+    cleanup_xargs_argtable(&args);
+    return 1;
+  }
+
+  xargs_source_t src = {
+    .in = jshell_io_stdin(),
+    .delim = args.null->count > 0 ? '\0' : '\n',
+    .max_size = default_max_size(),
+  };
+  int max_procs = args.max_procs->count > 0 ? args.max_procs->ival[0] : 1;
+  bool bad_limit = false;
+  if (args.max_args->count > 0) {
+    src.max_args = args.max_args->ival[0];
+    bad_limit = src.max_args < 1;
+  }
+  if (args.max_chars->count > 0) {
+    bad_limit = bad_limit || args.max_chars->ival[0] < 1;
+    if ((size_t)args.max_chars->ival[0] < src.max_size) {
+      src.max_size = (size_t)args.max_chars->ival[0];
+    }
+  }
+  cleanup_xargs_argtable(&args);
+
+  if (bad_limit || max_procs < 1) {
+    fprintf(stderr, "xargs: -n, -P and -s must be at least 1\n");
+    return 1;
+  }
+  if (max_procs > XARGS_MAX_PROCS) {
+    max_procs = XARGS_MAX_PROCS;
+  }
+
+  if (skip_separator) {
+    command_start++;
+  }
+
+  static char *default_command[] = { "echo", NULL };
+  src.template = command_start < argc ? &argv[command_start]
+                                      : default_command;
+  src.template_count = command_start < argc ? argc - command_start : 1;
+  for (int i = 0; i < src.template_count; i++) {
+    src.template_size += arg_size(src.template[i]);
+  }
+
+  const jshell_cmd_spec_t *spec = jshell_find_command(src.template[0]);
+  if (spec != NULL && spec->type == CMD_BUILTIN
+      && !jshell_builtin_is_pipeline_safe(spec->name)) {
+    fprintf(stderr, "xargs: %s changes shell state and cannot be run by "
+                    "xargs\n", src.template[0]);
+    return 1;
+  }
+
+  /* Builtins and linked apps run in-process; one at a time, those that
+   * only write through their stream need no capture pipe either. Other
+   * registered externals are spawned from their resolved path, as the
+   * shell itself runs them */
+  char *exec_path = NULL;
+  FILE *stream = NULL;
+  if (spec != NULL
+      && (spec->type == CMD_BUILTIN || jshell_is_linked_command(spec))) {
+    if (max_procs == 1
+        && (spec->type == CMD_BUILTIN
+            || jshell_linked_writes_stream_only(spec))) {
+      stream = jshell_io_stdout();
+    }
+  } else {
+    if (spec != NULL && spec->type == CMD_PACKAGE && spec->bin_path != NULL) {
+      exec_path = strdup(spec->bin_path);
+    } else {
+      exec_path = jshell_resolve_command(src.template[0]);
+    }
+    spec = NULL;
+  }
+
+  bool interrupted = false;
+  int result = run_batches(&src, spec, exec_path, stream, max_procs,
+                           &interrupted);
+
+  free(exec_path);
+  free(src.pending);
+  free(src.line);
+
+  if (interrupted) {
+    return 130;  /* 128 + SIGINT(2) */
+  }
+  return result;
+}
+
+
+/**
+ * Command specification for the xargs builtin
+ */
+const jshell_cmd_spec_t cmd_xargs_spec = {
+  .name = "xargs",
+  .summary = "run a command with arguments read from stdin",
+  .long_help = "Run COMMAND with the items from stdin appended, packing as\n"
+               "many into each run as the argument limit allows. Builtins\n"
+               "and linked apps run in-process; -P runs batches at once.",
+  .type = CMD_BUILTIN,
+  .run = xargs_run,
+  .print_usage = xargs_print_usage,
+  .describe_args = xargs_describe_args
+};
+
+
+/**
+ * Registers the xargs command with the shell command registry.
+ */
+void jshell_register_xargs_command(void) {
+  jshell_register_command(&cmd_xargs_spec);
+}
@@ -0,0 +1,12 @@
+#ifndef CMD_XARGS_H
+#define CMD_XARGS_H
+
+#include "jshell/jshell_cmd_registry.h"
+
+
+extern const jshell_cmd_spec_t cmd_xargs_spec;
+
+void jshell_register_xargs_command(void);
+
+
+#endif
@@ -3,9 +3,12 @@
  * @brief Main entry point and interactive loop for the jbox shell
  */
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "argtable3.h"
 
@@ -15,7 +18,9 @@
 
 #include "ast/jshell_ast_interpreter.h"
 #include "jshell_job_control.h"
+#include "jshell_event_loop.h"
 #include "jshell_history.h"
+#include "jshell_line_editor.h"
 #include "jshell_register_builtins.h"
 #include "jshell_register_externals.h"
 #include "jshell_pkg_loader.h"
@@ -23,6 +28,13 @@
 #include "jshell_signals.h"
 #include "jshell_env_loader.h"
 #include "jshell_ai.h"
+#include "jshell_server.h"
+#include "jshell_mcp.h"
+#include "jshell_parse_cache.h"
+#include "jshell_script_cache.h"
+#include "jshell_stats.h"
+#include "jshell_trace.h"
+#include "jshell_vars.h"
 #include "utils/jbox_utils.h"
 #include "jshell.h"
 
@@ -53,8 +65,12 @@ void jshell_set_last_exit_status(int status) {
 typedef struct {
   struct arg_lit *help;
   struct arg_str *cmd;
+  struct arg_lit *read_stdin;
+  struct arg_str *script;
+  struct arg_str *serve;
+  struct arg_lit *mcp;
   struct arg_end *end;
-  void *argtable[4];
+  void *argtable[8];
 } jshell_args_t;
 
 
@@ -65,12 +81,24 @@ typedef struct {
 static void build_jshell_argtable(jshell_args_t *args) {
   args->help = arg_lit0("h", "help", "display this help and exit");
   args->cmd  = arg_str0("c", NULL, "COMMAND", "execute command and exit");
+  args->read_stdin = arg_lit0("s", NULL,
+                              "read commands from standard input");
+  args->script = arg_str0(NULL, NULL, "SCRIPT",
+                          "run commands from SCRIPT and exit");
+  args->serve = arg_str0(NULL, "serve", "SOCKET",
+                         "answer JSON command requests on a Unix socket");
+  args->mcp = arg_lit0(NULL, "mcp",
+                       "serve commands as MCP tools on stdin/stdout");
   args->end  = arg_end(20);
 
   args->argtable[0] = args->help;
   args->argtable[1] = args->cmd;
-  args->argtable[2] = args->end;
-  args->argtable[3] = NULL;
+  args->argtable[2] = args->read_stdin;
+  args->argtable[3] = args->script;
+  args->argtable[4] = args->serve;
+  args->argtable[5] = args->mcp;
+  args->argtable[6] = args->end;
+  args->argtable[7] = NULL;
 }
 
 
@@ -96,69 +124,338 @@ void jshell_print_usage(FILE *out) {
   fprintf(out, "\njshell - the jbox shell\n\n");
   fprintf(out, "Options:\n");
   arg_print_glossary(out, args.argtable, "  %-20s %s\n");
-  fprintf(out, "\nWhen invoked without -c, runs in interactive mode.\n");
+  fprintf(out, "\nWhen invoked without -c, -s or SCRIPT, runs in interactive "
+               "mode.\n");
   cleanup_jshell_argtable(&args);
 }
 
 
 /**
- * Execute a single command string (non-interactive mode).
- * Initializes all shell subsystems, parses and executes the command.
- * @param cmd_string Command string to parse and execute
- * @return Exit status code of the executed command
+ * Initialize the shell subsystems shared by every mode, once per process.
+ * Also called by libjshell hosts through jshell_session_new().
+ * Costly subsystems that many commands never touch are deferred instead:
+ * package commands register on first lookup, AI on the first @ query.
  */
-int jshell_exec_string(const char *cmd_string) {
-  Input parse_tree;
+void jshell_init_shell(void) {
+  static bool initialized = false;
 
+  if (initialized) {
+    return;
+  }
+  initialized = true;
+
+  jshell_vars_init();
   jshell_init_signals();
+  jshell_init_job_control();  /* Before any thread so all block SIGCHLD */
   jshell_init_path();
   jshell_load_env_file();
-  jshell_ai_init();  /* Initialize AI after env is loaded */
-  jshell_init_job_control();
+  jshell_vars_sync_environ(); /* Startup readers below still use getenv() */
+  jshell_trace_init();        /* After .env, which may set JSHELL_TRACE */
+  jshell_stats_init();        /* Before --serve forks its connections */
   jshell_register_all_builtin_commands();
   jshell_register_all_external_commands();
-  jshell_load_installed_packages();
+  jshell_defer_package_loading();
+}
+
+
+/**
+ * Execute a single command string (non-interactive mode).
+ * Initializes the shell subsystems, parses and executes the command.
+ * @param cmd_string Command string to parse and execute
+ * @return Exit status code of the executed command
+ */
+int jshell_exec_string(const char *cmd_string) {
+  const JShellPlan* plan;
+
+  jshell_init_shell();
 
   g_last_exit_status = 0;
 
-  parse_tree = psInput(cmd_string);
+  plan = jshell_parse_cache_get(cmd_string);
 
-  if (parse_tree == NULL) {
+  if (plan == NULL) {
     fprintf(stderr, "jshell: parse error\n");
     return 1;
   }
 
-  DPRINT("%s", showInput(parse_tree));
+  jshell_exec_plan(plan);
+
+  return g_last_exit_status;
+}
+
+
+/**
+ * Recognize an `exit [N]` line in script mode.
+ * @param text Command text with leading blanks removed
+ * @param status Set to N, or to the last exit status if N is omitted
+ * @return true if text is an exit command
+ */
+static bool jshell_parse_exit(const char *text, int *status) {
+  if (strncmp(text, "exit", 4) != 0
+      || (text[4] != '\0' && text[4] != ' ' && text[4] != '\t')) {
+    return false;
+  }
+
+  const char *arg = text + 4 + strspn(text + 4, " \t");
+  if (*arg == '\0') {
+    *status = g_last_exit_status;
+    return true;
+  }
+
+  char *end;
+  long value = strtol(arg, &end, 10);
+  if (end == arg || end[strspn(end, " \t")] != '\0') {
+    return false;
+  }
+  *status = (int)(value & 0xff);
+  return true;
+}
+
+
+/**
+ * Run commands read from a stream (script and -s batch mode).
+ * The shell is initialized once for the whole stream, so each command
+ * costs only its parse (cached for repeated lines) and execution.
+ * A trailing backslash continues a command on the next line; blank lines
+ * and lines starting with '#' (including a #! line) are skipped.
+ * @param in Stream to read commands from
+ * @param name Script name used in error messages
+ * @param compiler Records the plans run, for the compiled script cache;
+ *                 NULL when the stream is not a script file
+ * @return Exit status of the last command, or 1 after a parse error
+ */
+static int jshell_exec_stream(FILE *in, const char *name,
+                              JShellScriptCompiler *compiler) {
+  char *line = NULL;
+  size_t line_cap = 0;
+  char *command = NULL;
+  size_t command_len = 0;
+  size_t command_cap = 0;
+  size_t line_no = 0;
+  size_t command_line = 0;
+  ssize_t len;
+
+  jshell_init_shell();
+
+  g_last_exit_status = 0;
+
+  while ((len = getline(&line, &line_cap, in)) != -1) {
+    line_no++;
+
+    if (len > 0 && line[len - 1] == '\n') {
+      line[--len] = '\0';
+    }
+
+    bool continued = len > 0 && line[len - 1] == '\\';
+    if (continued) {
+      line[--len] = '\0';
+    }
+
+    if (command_len == 0) {
+      command_line = line_no;
+    }
+
+    size_t needed = command_len + (size_t)len + 2;
+    if (needed > command_cap) {
+      size_t new_cap = command_cap ? command_cap : 256;
+      while (new_cap < needed) {
+        new_cap *= 2;
+      }
+      char *grown = realloc(command, new_cap);
+      if (grown == NULL) {
+        perror("jshell: realloc");
+        g_last_exit_status = 1;
+        jshell_script_compiler_fail(compiler);
+        break;
+      }
+      command = grown;
+      command_cap = new_cap;
+    }
+    memcpy(command + command_len, line, (size_t)len);
+    command_len += (size_t)len;
+    if (continued) {
+      command[command_len++] = ' ';
+    }
+    command[command_len] = '\0';
+
+    if (continued) {
+      continue;
+    }
+
+    const char *text = command + strspn(command, " \t");
+    command_len = 0;
+
+    if (*text == '\0' || *text == '#') {
+      continue;
+    }
+
+    if (jshell_should_terminate() || jshell_should_hangup()) {
+      DPRINT("Received termination signal, stopping script");
+      jshell_script_compiler_fail(compiler);
+      break;
+    }
+
+    int exit_status;
+    if (jshell_parse_exit(text, &exit_status)) {
+      bool bare = text[4 + strspn(text + 4, " \t")] == '\0';
+      jshell_script_compiler_add_exit(compiler, bare ? -1 : exit_status);
+      g_last_exit_status = exit_status;
+      break;
+    }
+
+    const JShellPlan* plan = jshell_parse_cache_get(command);
+
+    if (plan == NULL) {
+      fprintf(stderr, "jshell: %s:%zu: parse error\n", name, command_line);
+      g_last_exit_status = 1;
+      jshell_script_compiler_fail(compiler);
+      break;
+    }
+
+    jshell_script_compiler_add_plan(compiler, plan);
+    jshell_exec_plan(plan);
+  }
+
+  free(line);
+  free(command);
+
+  return g_last_exit_status;
+}
+
+
+/**
+ * Run the steps of a compiled script; the counterpart of
+ * jshell_exec_stream() without reading or parsing a line.
+ * @param script Compiled script from the cache
+ * @return Exit status of the last command or of exit
+ */
+static int jshell_exec_compiled(const JShellCompiledScript *script) {
+  g_last_exit_status = 0;
 
-  interpretInput(parse_tree);
+  for (size_t i = 0; i < script->step_count; i++) {
+    if (jshell_should_terminate() || jshell_should_hangup()) {
+      DPRINT("Received termination signal, stopping script");
+      break;
+    }
 
-  free_Input(parse_tree);
+    const JShellScriptStep *step = &script->steps[i];
+    if (step->kind == SCRIPT_STEP_EXIT) {
+      if (step->exit_status >= 0) {
+        g_last_exit_status = step->exit_status;
+      }
+      break;
+    }
+    jshell_exec_plan(step->plan);
+  }
 
   return g_last_exit_status;
 }
 
 
+/**
+ * Read a whole regular file.
+ * @param fp Open file
+ * @param len Set to the number of bytes read
+ * @return Allocated contents, or NULL if fp is not a regular file or on
+ *         error
+ */
+static char *jshell_read_script(FILE *fp, size_t *len) {
+  struct stat st;
+  if (fstat(fileno(fp), &st) != 0 || !S_ISREG(st.st_mode)) {
+    return NULL;
+  }
+
+  size_t cap = (size_t)st.st_size + 1;
+  char *text = malloc(cap);
+  if (text == NULL) {
+    return NULL;
+  }
+  size_t n = fread(text, 1, cap, fp);
+  if (ferror(fp) || n == cap) {
+    /* Read error or the file grew while read: stream it instead */
+    free(text);
+    rewind(fp);
+    return NULL;
+  }
+  *len = n;
+  return text;
+}
+
+
+/**
+ * Run a script file.
+ * A regular file is read whole: if its compiled form is cached, the
+ * plans run without parsing; otherwise it runs from memory and is
+ * compiled along the way, so the cached form matches what ran.
+ * @param path Path of the script
+ * @return Exit status of the script, or 127 if it cannot be opened
+ */
+static int jshell_exec_script(const char *path) {
+  /* Close-on-exec keeps the script out of the commands it runs */
+  FILE *fp = fopen(path, "re");
+  if (fp == NULL) {
+    fprintf(stderr, "jshell: %s: %s\n", path, strerror(errno));
+    return 127;
+  }
+
+  jshell_init_shell();
+
+  size_t source_len = 0;
+  char *source = jshell_read_script(fp, &source_len);
+  if (source == NULL) {
+    int status = jshell_exec_stream(fp, path, NULL);
+    fclose(fp);
+    return status;
+  }
+  fclose(fp);
+
+  int status;
+  JShellCompiledScript script;
+  JShellScriptCompiler compiler;
+  if (jshell_script_cache_load(source, source_len, &script)) {
+    status = jshell_exec_compiled(&script);
+    jshell_script_cache_unload(&script);
+  } else {
+    bool compiling = jshell_script_compiler_init(&compiler);
+    FILE *in = source_len > 0 ? fmemopen(source, source_len, "r")
+                              : fopen("/dev/null", "re");
+    if (in == NULL) {
+      fprintf(stderr, "jshell: %s: %s\n", path, strerror(errno));
+      jshell_script_compiler_fail(compiling ? &compiler : NULL);
+      status = 127;
+    } else {
+      status = jshell_exec_stream(in, path, compiling ? &compiler : NULL);
+      fclose(in);
+    }
+    if (compiling) {
+      jshell_script_compiler_finish(&compiler, source, source_len);
+    }
+  }
+
+  free(source);
+  return status;
+}
+
+
 /**
  * Run the shell in interactive mode (REPL).
  * Displays prompt, reads commands, parses and executes them in a loop.
- * Handles line continuation (backslash), command history, and signals.
+ * On a terminal, lines are read with the line editor (history browsing and
+ * tab completion). Handles line continuation (backslash), command history,
+ * and signals.
  * @return Exit status code (0 on normal exit)
  */
 static int jshell_interactive(void) {
   char line[1024];
   char full_line[4096] = "";
 
-  Input parse_tree;
+  const JShellPlan* plan;
+  bool watch_input = isatty(STDIN_FILENO);
+  bool use_editor = watch_input && isatty(STDOUT_FILENO);
 
-  jshell_init_signals();
-  jshell_init_path();
-  jshell_load_env_file();
-  jshell_ai_init();  /* Initialize AI after env is loaded */
-  jshell_init_job_control();
+  jshell_init_shell();
   jshell_history_init();
-  jshell_register_all_builtin_commands();
-  jshell_register_all_external_commands();
-  jshell_load_installed_packages();
+  jshell_spool_enable();
 
   while (true) {
     /* Check for termination signals */
@@ -172,20 +469,53 @@ static int jshell_interactive(void) {
     /* Clear any pending interrupt before prompting */
     jshell_clear_interrupted();
 
-    printf("(jsh)>");
-    fflush(stdout);
-
-    if (fgets(line, sizeof(line), stdin) == NULL) {
-      /* Check if fgets was interrupted by SIGINT */
-      if (jshell_check_interrupted()) {
-        printf("\n");  /* Move to new line after ^C */
-        full_line[0] = '\0';  /* Clear any partial input */
-        clearerr(stdin);  /* Clear EOF flag set by interrupted read */
+    if (use_editor) {
+      JShellLineResult result = jshell_line_read("(jsh)>", line,
+                                                 sizeof(line));
+      if (result == JSHELL_LINE_EOF) {
+        break;
+      }
+      if (result == JSHELL_LINE_INTERRUPTED) {
+        full_line[0] = '\0';
         continue;
       }
-      /* Actual EOF (Ctrl+D) */
-      printf("\n");
-      break;
+      if (result == JSHELL_LINE_ERROR) {
+        use_editor = false;  /* Fall back to plain reads */
+        continue;
+      }
+    } else {
+      printf("(jsh)>");
+      fflush(stdout);
+
+      /* A terminal delivers one line per read, so nothing is left
+       * buffered in stdin and it is safe to wait on the descriptor */
+      if (watch_input) {
+        JShellEvent event = jshell_event_wait_input(STDIN_FILENO);
+        if (event == JSHELL_EVENT_JOBS_DONE) {
+          printf("\n");  /* Report on a fresh line, then prompt again */
+          continue;
+        }
+        if (event == JSHELL_EVENT_INTERRUPTED) {
+          if (jshell_check_interrupted()) {
+            printf("\n");
+            full_line[0] = '\0';
+          }
+          continue;
+        }
+      }
+
+      if (fgets(line, sizeof(line), stdin) == NULL) {
+        /* Check if fgets was interrupted by SIGINT */
+        if (jshell_check_interrupted()) {
+          printf("\n");  /* Move to new line after ^C */
+          full_line[0] = '\0';  /* Clear any partial input */
+          clearerr(stdin);  /* Clear EOF flag set by interrupted read */
+          continue;
+        }
+        /* Actual EOF (Ctrl+D) */
+        printf("\n");
+        break;
+      }
     }
 
     /* Check if we were interrupted during input */
@@ -219,22 +549,22 @@ static int jshell_interactive(void) {
 
     /* Handle exit command */
     if (strcmp(full_line, "exit") == 0) {
+      jshell_history_finish(0);
       exit(0);
     }
 
-    parse_tree = psInput(full_line);
+    /* Cached plans are owned by the cache and reused on repeated lines */
+    plan = jshell_parse_cache_get(full_line);
 
-    if (parse_tree == NULL) {
+    if (plan == NULL) {
       fprintf(stderr, "\033[31mParse Error: Invalid Input!\033[0m\n");
+      jshell_history_finish(1);
       full_line[0] = '\0';
       continue;
     }
 
-    DPRINT("%s", showInput(parse_tree));
-
-    interpretInput(parse_tree);
-
-    free_Input(parse_tree);
+    jshell_exec_plan(plan);
+    jshell_history_finish(jshell_get_last_exit_status());
 
     full_line[0] = '\0';
   }
@@ -246,7 +576,9 @@ static int jshell_interactive(void) {
 /**
  * Main entry point for the jshell shell.
  * Parses command-line arguments and either executes a single command
- * (with -c option) or runs in interactive mode.
+ * (with -c option), runs a script (SCRIPT, or stdin with -s), serves
+ * clients on a socket (--serve), serves commands as MCP tools (--mcp) or
+ * runs in interactive mode.
  * @param argc Argument count
  * @param argv Argument vector
  * @return Exit status code
@@ -276,6 +608,34 @@ int jshell_main(int argc, char **argv) {
     return status;
   }
 
+  if (args.serve->count > 0) {
+    /* Load everything up front: every client forks from this state */
+    jshell_init_shell();
+    jshell_load_installed_packages();
+    jshell_ai_init();
+    int status = jshell_serve(args.serve->sval[0]);
+    cleanup_jshell_argtable(&args);
+    return status;
+  }
+
+  if (args.mcp->count > 0) {
+    jshell_init_shell();
+    int status = jshell_mcp_serve();
+    cleanup_jshell_argtable(&args);
+    return status;
+  }
+
+  if (args.read_stdin->count > 0) {
+    cleanup_jshell_argtable(&args);
+    return jshell_exec_stream(stdin, "stdin", NULL);
+  }
+
+  if (args.script->count > 0) {
+    int status = jshell_exec_script(args.script->sval[0]);
+    cleanup_jshell_argtable(&args);
+    return status;
+  }
+
   cleanup_jshell_argtable(&args);
 
   return jshell_interactive();
@@ -6,6 +6,8 @@
 
 int jshell_main(int argc, char **argv);
 
+void jshell_init_shell(void);
+
 int jshell_exec_string(const char *cmd_string);
 
 void jshell_print_usage(FILE *out);
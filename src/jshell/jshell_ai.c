@@ -7,13 +7,20 @@
  * - Execute queries (@!query): AI-generated shell commands
  */
 
+#include <ctype.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
 
 #include "jshell_ai.h"
+#include "jshell_ai_cache.h"
 #include "jshell_ai_context.h"
+#include "jshell_cmd_registry.h"
 #include "jshell_gemini_api.h"
+#include "ast/jshell_ast_parser.h"
 #include "utils/jbox_utils.h"
 
 
@@ -26,6 +33,18 @@
 /** Maximum tokens for command generation responses */
 #define AI_EXEC_MAX_TOKENS 512
 
+/** Lifetime of the cached exec context, in seconds */
+#define AI_EXEC_CACHE_TTL 3600
+
+/** Renew the cached exec context this many seconds before it expires */
+#define AI_EXEC_CACHE_MARGIN 60
+
+/** Most commands whose full usage is sent with an exec query */
+#define AI_EXEC_MAX_RELEVANT 6
+
+/** Leading word of an exec query that bypasses the command cache */
+#define AI_NO_CACHE_FLAG "--no-cache"
+
 
 /** System prompt for chat queries (no command context) */
 static const char *CHAT_SYSTEM_PROMPT =
@@ -37,6 +56,12 @@ static const char *CHAT_SYSTEM_PROMPT =
 typedef struct {
   char *api_key;      /**< Google API key from environment */
   int initialized;    /**< 1 if module is initialized, 0 otherwise */
+  char *exec_system_json;   /**< Exec system prompt, escaped once */
+  char *exec_cache_name;    /**< Cached content holding it, or NULL */
+  time_t exec_cache_expires;
+  int exec_cache_refused;   /**< The API would not cache it this session */
+  uint64_t exec_context_hash; /**< Hash of the model and exec prompt */
+  unsigned long exec_generation; /**< Registry generation it lists */
 } AIContext;
 
 /** Global AI context singleton */
@@ -82,22 +107,36 @@ int jshell_ai_init(void) {
 /**
  * Clean up the AI module and free all resources.
  *
- * Frees the API key and resets the module to uninitialized state.
+ * Frees the API key and the prepared exec context and resets the module
+ * to uninitialized state. A cached exec context left on the API side
+ * expires by itself.
  * Safe to call multiple times.
  */
 void jshell_ai_cleanup(void) {
   free(g_ai_ctx.api_key);
+  free(g_ai_ctx.exec_system_json);
+  free(g_ai_ctx.exec_cache_name);
   g_ai_ctx.api_key = NULL;
+  g_ai_ctx.exec_system_json = NULL;
+  g_ai_ctx.exec_cache_name = NULL;
+  g_ai_ctx.exec_cache_refused = 0;
   g_ai_ctx.initialized = 0;
+  jshell_ai_cache_clear();
 }
 
 
 /**
  * Check if AI functionality is currently available.
  *
+ * Initializes the module on first use, so shells that never issue an AI
+ * query skip it, and a GOOGLE_API_KEY exported later is still picked up.
+ *
  * @return 1 if the module is initialized and has a valid API key, 0 otherwise
  */
 int jshell_ai_available(void) {
+  if (!g_ai_ctx.initialized) {
+    jshell_ai_init();
+  }
   return g_ai_ctx.initialized && g_ai_ctx.api_key != NULL;
 }
 
@@ -151,6 +190,506 @@ char *jshell_ai_chat(const char *query) {
 }
 
 
+/** Caller of a background chat query */
+typedef struct {
+  JShellAIDoneFn done;
+  void *ctx;
+} ChatAsync;
+
+
+/**
+ * Turn the response to a background chat query into an answer for its
+ * caller. Runs on the Gemini background thread.
+ *
+ * @param resp Response to the query, freed here
+ * @param ctx ChatAsync of the query, freed here
+ */
+static void chat_async_done(GeminiResponse *resp, void *ctx) {
+  ChatAsync *async = ctx;
+
+  char *answer = NULL;
+  int status = 0;
+  if (resp->success && resp->content) {
+    answer = strdup(resp->content);
+  } else {
+    const char *error = resp->error ? resp->error : "Unknown error";
+    size_t len = strlen(error) + 32;
+    answer = malloc(len);
+    if (answer) {
+      snprintf(answer, len, "AI error: %s", error);
+    }
+    status = 1;
+  }
+  jshell_free_gemini_response(resp);
+
+  async->done(answer, status, async->ctx);
+  free(async);
+}
+
+
+/**
+ * Send a chat query to the AI without waiting for the answer.
+ *
+ * The query runs on the Gemini background thread alongside any others in
+ * flight, sharing one connection; see jshell_gemini_submit(). Must be
+ * called from the main thread, which initializes the module.
+ *
+ * @param query User's chat message (NULL or empty defaults to "Hi!")
+ * @param cancel Polled while the query runs; setting it abandons the
+ *        query (may be NULL)
+ * @param done Called from another thread with the answer (or an
+ *        "AI error: ..." message; it owns the string, which may be NULL if
+ *        out of memory) and 0, or 1 on error
+ * @param ctx Passed to done
+ * @return 0 if the query was started, -1 otherwise (done is not called)
+ */
+int jshell_ai_chat_async(const char *query, const atomic_bool *cancel,
+                         JShellAIDoneFn done, void *ctx) {
+  if (!jshell_ai_available()) {
+    return -1;
+  }
+
+  if (!query || query[0] == '\0') {
+    query = "Hi!";
+  }
+
+  ChatAsync *async = malloc(sizeof(ChatAsync));
+  if (!async) {
+    return -1;
+  }
+  async->done = done;
+  async->ctx = ctx;
+
+  DPRINT("AI background chat query: %s", query);
+
+  if (jshell_gemini_submit(g_ai_ctx.api_key, AI_MODEL, CHAT_SYSTEM_PROMPT,
+                           query, AI_CHAT_MAX_TOKENS, cancel,
+                           chat_async_done, async) != 0) {
+    free(async);
+    return -1;
+  }
+  return 0;
+}
+
+
+/** Where a streamed chat answer is printed */
+typedef struct {
+  FILE *out;
+  int at_line_start;  /**< Nothing printed yet, or it ended in a newline */
+} ChatStream;
+
+
+/**
+ * Print one piece of a streamed chat answer.
+ *
+ * @param text Text received
+ * @param len Length of text
+ * @param ctx ChatStream to print to
+ */
+static void print_chat_text(const char *text, size_t len, void *ctx) {
+  ChatStream *stream = ctx;
+  fwrite(text, 1, len, stream->out);
+  fflush(stream->out);
+  stream->at_line_start = text[len - 1] == '\n';
+}
+
+
+/**
+ * Send a chat query to the AI and print the answer as it streams in.
+ *
+ * Unlike jshell_ai_chat(), the first words appear as soon as the API
+ * sends them rather than once the whole answer is complete.
+ *
+ * @param query User's chat message (NULL or empty defaults to "Hi!")
+ * @param out Stream to print the answer to
+ * @return 0 on success, 1 on error
+ */
+int jshell_ai_chat_stream(const char *query, FILE *out) {
+  if (!jshell_ai_available()) {
+    fprintf(out, "AI not available (GOOGLE_API_KEY not set)\n");
+    return 1;
+  }
+
+  if (!query || query[0] == '\0') {
+    query = "Hi!";
+  }
+
+  DPRINT("AI chat query: %s", query);
+
+  ChatStream stream = { .out = out, .at_line_start = 1 };
+  GeminiResponse resp = jshell_gemini_stream(
+    g_ai_ctx.api_key,
+    AI_MODEL,
+    CHAT_SYSTEM_PROMPT,
+    query,
+    AI_CHAT_MAX_TOKENS,
+    print_chat_text,
+    &stream
+  );
+
+  if (!stream.at_line_start) {
+    fputc('\n', out);
+  }
+  int ret = 0;
+  if (!resp.success) {
+    fprintf(out, "AI error: %s\n",
+            resp.error ? resp.error : "Unknown error");
+    ret = 1;
+  }
+  fflush(out);
+
+  jshell_free_gemini_response(&resp);
+  return ret;
+}
+
+
+/**
+ * Forget the cached exec context, so the next query sends it inline and
+ * renews the cache.
+ */
+static void drop_exec_cache(void) {
+  free(g_ai_ctx.exec_cache_name);
+  g_ai_ctx.exec_cache_name = NULL;
+  g_ai_ctx.exec_cache_expires = 0;
+}
+
+
+/**
+ * Hash bytes into a running FNV-1a hash.
+ *
+ * @param hash Hash so far
+ * @param data Bytes to add
+ * @param len Number of bytes
+ * @return Updated hash
+ */
+static uint64_t fnv1a(uint64_t hash, const char *data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (unsigned char)data[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+
+/**
+ * Print a registered command's summary line into the exec prompt.
+ *
+ * @param spec Registered command
+ * @param userdata Stream being rendered to (FILE*)
+ */
+static void print_command_summary(const jshell_cmd_spec_t *spec,
+                                  void *userdata) {
+  FILE *out = userdata;
+  if (spec->summary && spec->summary[0] != '\0') {
+    fprintf(out, "%s - %s\n", spec->name, spec->summary);
+  } else {
+    fprintf(out, "%s\n", spec->name);
+  }
+}
+
+
+/**
+ * Bring the exec system prompt up to date with the command registry.
+ *
+ * The prompt is the instructions, the grammar and one summary line per
+ * registered command, packages included. It is rendered and escaped into
+ * JSON only when the registry's generation has changed since the last
+ * time, and a change also retires the cached content made from the old
+ * prompt.
+ *
+ * @return 0 on success, -1 on allocation failure
+ */
+static int refresh_exec_prompt(void) {
+  unsigned long generation = jshell_get_registry_generation();
+  if (g_ai_ctx.exec_system_json && generation == g_ai_ctx.exec_generation) {
+    return 0;
+  }
+
+  char *system_prompt = NULL;
+  size_t prompt_size = 0;
+  FILE *out = open_memstream(&system_prompt, &prompt_size);
+  if (!out) {
+    return -1;
+  }
+  fprintf(out,
+          "%s\n\n"
+          "=== SHELL GRAMMAR ===\n%s\n\n"
+          "=== AVAILABLE COMMANDS ===\n",
+          EXEC_INSTRUCTIONS,
+          GRAMMAR_CONTEXT);
+  jshell_for_each_command(print_command_summary, out);
+  fprintf(out, "\nFull usage of the commands that look relevant is given "
+               "with each request.\n");
+  if (fclose(out) != 0) {
+    free(system_prompt);
+    return -1;
+  }
+
+  DPRINT("AI exec system prompt:\n%s", system_prompt);
+  char *system_json = jshell_gemini_system_json(system_prompt);
+  if (!system_json) {
+    free(system_prompt);
+    return -1;
+  }
+
+  uint64_t hash = fnv1a(0xcbf29ce484222325ULL, AI_MODEL, sizeof(AI_MODEL));
+  g_ai_ctx.exec_context_hash = fnv1a(hash, system_prompt, prompt_size);
+  free(system_prompt);
+
+  free(g_ai_ctx.exec_system_json);
+  g_ai_ctx.exec_system_json = system_json;
+  g_ai_ctx.exec_generation = generation;
+  drop_exec_cache();
+  return 0;
+}
+
+
+/**
+ * Prepare the system instruction for exec queries.
+ *
+ * The prompt only changes with the registry, so it is escaped into JSON
+ * once per change (see refresh_exec_prompt()). It is also uploaded as
+ * cached content, renewed shortly before it expires; queries then name
+ * the cache instead of sending the whole prefix. If the API will not
+ * cache it, queries carry the escaped instruction inline.
+ *
+ * @return Context for the query; system_json is NULL on allocation failure
+ */
+static GeminiContext exec_context(void) {
+  GeminiContext context = { .system_json = NULL, .cached_content = NULL };
+
+  if (refresh_exec_prompt() != 0) {
+    return context;
+  }
+  context.system_json = g_ai_ctx.exec_system_json;
+
+  time_t now = time(NULL);
+  if (g_ai_ctx.exec_cache_name && now >= g_ai_ctx.exec_cache_expires) {
+    drop_exec_cache();
+  }
+  if (!g_ai_ctx.exec_cache_name && !g_ai_ctx.exec_cache_refused) {
+    char *error = NULL;
+    g_ai_ctx.exec_cache_name = jshell_gemini_cache_create(
+      g_ai_ctx.api_key,
+      AI_MODEL,
+      g_ai_ctx.exec_system_json,
+      AI_EXEC_CACHE_TTL,
+      &error
+    );
+    if (g_ai_ctx.exec_cache_name) {
+      g_ai_ctx.exec_cache_expires = now + AI_EXEC_CACHE_TTL
+                                    - AI_EXEC_CACHE_MARGIN;
+    } else {
+      /* Don't pay for a failing upload on every query */
+      DPRINT("AI exec context not cached: %s", error ? error : "unknown");
+      g_ai_ctx.exec_cache_refused = 1;
+    }
+    free(error);
+  }
+  context.cached_content = g_ai_ctx.exec_cache_name;
+
+  return context;
+}
+
+
+/**
+ * Fingerprint what a generated command depends on besides the query.
+ *
+ * Covers the model and the exec prompt, which lists the commands
+ * registered right now, so installing or removing a package retires
+ * answers that may name commands that no longer exist.
+ *
+ * @return Fingerprint for the command cache
+ */
+static uint64_t exec_fingerprint(void) {
+  refresh_exec_prompt();
+  return g_ai_ctx.exec_context_hash;
+}
+
+
+/**
+ * Check that a cached command parses before it answers a query it was
+ * not generated for.
+ *
+ * @param command Command text
+ * @return 1 if the shell grammar accepts it, 0 otherwise
+ */
+static int command_parses(const char *command) {
+  JShellParser parser = {0};
+  int ok = jshell_parser_parse(&parser, command) != NULL;
+  jshell_parser_destroy(&parser);
+  return ok;
+}
+
+
+/** Words too common to pick out a command */
+static const char *const STOP_WORDS[] = {
+  "a", "all", "an", "and", "are", "as", "at", "be", "by", "do", "for",
+  "from", "in", "into", "is", "it", "me", "my", "of", "on", "or", "show",
+  "that", "the", "them", "then", "this", "to", "with", NULL
+};
+
+
+/** A query's keywords and the commands they match best so far */
+typedef struct {
+  char words[32][32];
+  int word_count;
+  const jshell_cmd_spec_t *top[AI_EXEC_MAX_RELEVANT];
+  int top_score[AI_EXEC_MAX_RELEVANT];
+  int top_count;
+} RelevanceState;
+
+
+/**
+ * Split a query into lowercase keywords, dropping stop words and a plural
+ * "s" so "files" finds "file".
+ *
+ * @param query Query text
+ * @param st State to fill in
+ */
+static void query_keywords(const char *query, RelevanceState *st) {
+  const char *p = query;
+  while (*p && st->word_count < 32) {
+    while (*p && !isalnum((unsigned char)*p)) {
+      p++;
+    }
+    size_t len = 0;
+    char *word = st->words[st->word_count];
+    while (isalnum((unsigned char)*p) || *p == '-' || *p == '_') {
+      if (len < 31) {
+        word[len++] = (char)tolower((unsigned char)*p);
+      }
+      p++;
+    }
+    word[len] = '\0';
+    if (len > 3 && word[len - 1] == 's') {
+      word[len - 1] = '\0';
+    }
+
+    int stop = len < 2;
+    for (int i = 0; !stop && STOP_WORDS[i]; i++) {
+      stop = strcmp(word, STOP_WORDS[i]) == 0;
+    }
+    if (!stop) {
+      st->word_count++;
+    }
+  }
+}
+
+
+/**
+ * Check whether text contains a word, ignoring case.
+ *
+ * @param text Text to search (may be NULL)
+ * @param word Lowercase word
+ * @return 1 if found, 0 otherwise
+ */
+static int mentions(const char *text, const char *word) {
+  size_t len = strlen(word);
+  for (const char *p = text; p && *p; p++) {
+    if (strncasecmp(p, word, len) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+/**
+ * Score a registered command against the query's keywords and keep it if
+ * it is among the best so far.
+ *
+ * A keyword naming the command counts most, then one within its name,
+ * its summary and its long help.
+ *
+ * @param spec Registered command
+ * @param userdata RelevanceState
+ */
+static void rank_command(const jshell_cmd_spec_t *spec, void *userdata) {
+  RelevanceState *st = userdata;
+  int score = 0;
+  for (int i = 0; i < st->word_count; i++) {
+    const char *word = st->words[i];
+    if (strcmp(word, spec->name) == 0) {
+      score += 10;
+    } else if (strlen(word) >= 3 && mentions(spec->name, word)) {
+      score += 4;
+    }
+    score += 2 * mentions(spec->summary, word);
+    score += mentions(spec->long_help, word);
+  }
+  if (score == 0) {
+    return;
+  }
+
+  /* Insertion into the short sorted list of best matches */
+  int pos = st->top_count;
+  while (pos > 0 && st->top_score[pos - 1] < score) {
+    pos--;
+  }
+  if (pos >= AI_EXEC_MAX_RELEVANT) {
+    return;
+  }
+  int last = st->top_count < AI_EXEC_MAX_RELEVANT ? st->top_count
+                                                  : AI_EXEC_MAX_RELEVANT - 1;
+  for (int i = last; i > pos; i--) {
+    st->top[i] = st->top[i - 1];
+    st->top_score[i] = st->top_score[i - 1];
+  }
+  st->top[pos] = spec;
+  st->top_score[pos] = score;
+  if (st->top_count < AI_EXEC_MAX_RELEVANT) {
+    st->top_count++;
+  }
+}
+
+
+/**
+ * Build the message for an exec query: the full usage of the commands
+ * its keywords point at, then the request itself.
+ *
+ * @param query Query text
+ * @return Newly allocated message, or NULL on allocation failure
+ */
+static char *build_exec_message(const char *query) {
+  RelevanceState st = { .word_count = 0, .top_count = 0 };
+  query_keywords(query, &st);
+  if (st.word_count > 0) {
+    jshell_for_each_command(rank_command, &st);
+  }
+
+  char *message = NULL;
+  size_t message_size = 0;
+  FILE *out = open_memstream(&message, &message_size);
+  if (!out) {
+    return NULL;
+  }
+
+  if (st.top_count > 0) {
+    fprintf(out, "=== RELEVANT COMMANDS ===\n");
+    for (int i = 0; i < st.top_count; i++) {
+      const jshell_cmd_spec_t *spec = st.top[i];
+      fprintf(out, "=== %s ===\n", spec->name);
+      if (spec->print_usage) {
+        spec->print_usage(out);
+      } else {
+        fprintf(out, "%s\n", spec->long_help ? spec->long_help
+                             : spec->summary ? spec->summary : "");
+      }
+      fprintf(out, "\n");
+    }
+    fprintf(out, "=== REQUEST ===\n");
+  }
+  fprintf(out, "%s", query);
+
+  if (fclose(out) != 0) {
+    free(message);
+    return NULL;
+  }
+  return message;
+}
+
+
 /**
  * Generate a shell command from a natural language query.
  *
@@ -161,7 +700,15 @@ char *jshell_ai_chat(const char *query) {
  * The system prompt includes:
  * - Execution instructions for the AI
  * - Shell grammar specification
- * - Available command documentation
+ * - A summary line for each registered command
+ *
+ * The query itself is preceded by the full usage of the few commands its
+ * keywords point at.
+ *
+ * Answers are memoized per normalized query (see jshell_ai_cache.h); a
+ * query worded much like a cached one reuses its command if that still
+ * parses. A query starting with --no-cache skips the lookup and asks the
+ * AI, and its answer replaces the cached one.
  *
  * @param query Natural language description of desired command
  * @return Newly allocated string with generated command (trimmed of whitespace),
@@ -173,41 +720,81 @@ char *jshell_ai_execute_query(const char *query) {
     return NULL;
   }
 
-  if (!query || query[0] == '\0') {
+  if (!query) {
     return NULL;
   }
 
-  /* Build system prompt from embedded context */
-  size_t prompt_size = strlen(EXEC_INSTRUCTIONS)
-                     + strlen(GRAMMAR_CONTEXT)
-                     + strlen(CMD_CONTEXT)
-                     + 128;  /* padding for separators */
-
-  char *system_prompt = malloc(prompt_size);
-  if (!system_prompt) {
+  int use_cache = 1;
+  while (isspace((unsigned char)*query)) {
+    query++;
+  }
+  size_t flag_len = strlen(AI_NO_CACHE_FLAG);
+  if (strncmp(query, AI_NO_CACHE_FLAG, flag_len) == 0
+      && (query[flag_len] == '\0'
+          || isspace((unsigned char)query[flag_len]))) {
+    use_cache = 0;
+    query += flag_len;
+    while (isspace((unsigned char)*query)) {
+      query++;
+    }
+  }
+  if (query[0] == '\0') {
     return NULL;
   }
 
-  snprintf(system_prompt, prompt_size,
-           "%s\n\n"
-           "=== SHELL GRAMMAR ===\n%s\n\n"
-           "=== AVAILABLE COMMANDS ===\n%s",
-           EXEC_INSTRUCTIONS,
-           GRAMMAR_CONTEXT,
-           CMD_CONTEXT);
+  uint64_t fingerprint = exec_fingerprint();
+  if (use_cache) {
+    char *cached = jshell_ai_cache_get(query, fingerprint);
+    if (cached) {
+      return cached;
+    }
+    char *similar = NULL;
+    cached = jshell_ai_cache_get_similar(query, fingerprint, command_parses,
+                                         &similar);
+    if (cached) {
+      fprintf(stderr, "jshell: reusing the command for \"%s\"\n", similar);
+      free(similar);
+      return cached;
+    }
+  }
+
+  GeminiContext context = exec_context();
+  if (!context.system_json) {
+    return NULL;
+  }
+  char *message = build_exec_message(query);
+  if (!message) {
+    return NULL;
+  }
 
   DPRINT("AI exec query: %s", query);
-  DPRINT("AI exec system prompt:\n%s", system_prompt);
+  DPRINT("AI exec context: %s", context.cached_content
+                                ? context.cached_content : "inline");
 
-  GeminiResponse resp = jshell_gemini_request(
+  GeminiResponse resp = jshell_gemini_request_context(
     g_ai_ctx.api_key,
     AI_MODEL,
-    system_prompt,
-    query,
+    &context,
+    message,
     AI_EXEC_MAX_TOKENS
   );
 
-  free(system_prompt);
+  /* The cached context may have been evicted early; send it inline */
+  if (!resp.success && context.cached_content && resp.http_code >= 400
+      && resp.http_code < 500) {
+    DPRINT("AI exec cached context failed: %s", resp.error);
+    drop_exec_cache();
+    jshell_free_gemini_response(&resp);
+    context.cached_content = NULL;
+    resp = jshell_gemini_request_context(
+      g_ai_ctx.api_key,
+      AI_MODEL,
+      &context,
+      message,
+      AI_EXEC_MAX_TOKENS
+    );
+  }
+  free(message);
 
   char *result = NULL;
   if (resp.success && resp.content) {
@@ -230,6 +817,7 @@ char *jshell_ai_execute_query(const char *query) {
       if (result) {
         memcpy(result, start, len);
         result[len] = '\0';
+        jshell_ai_cache_put(query, fingerprint, result);
       }
     }
   } else if (resp.error) {
@@ -1,6 +1,9 @@
 #ifndef JSHELL_AI_H
 #define JSHELL_AI_H
 
+#include <stdatomic.h>
+#include <stdio.h>
+
 /**
  * AI module for jshell
  *
@@ -23,7 +26,7 @@ int jshell_ai_init(void);
 void jshell_ai_cleanup(void);
 
 /**
- * Check if AI functionality is available.
+ * Check if AI functionality is available, initializing it on first use.
  * Returns 1 if API key is set and AI is ready, 0 otherwise.
  */
 int jshell_ai_available(void);
@@ -35,6 +38,29 @@ int jshell_ai_available(void);
  */
 char *jshell_ai_chat(const char *query);
 
+/**
+ * Send a simple chat query to the AI, printing the answer to out as it
+ * streams in, followed by a newline.
+ * Errors are printed to out as "AI error: ...".
+ * Returns 0 on success, 1 on error.
+ */
+int jshell_ai_chat_stream(const char *query, FILE *out);
+
+/**
+ * Receives the answer to a background chat query, on another thread.
+ * answer is "AI error: ..." when status is 1; the callee must free it.
+ */
+typedef void (*JShellAIDoneFn)(char *answer, int status, void *ctx);
+
+/**
+ * Send a simple chat query to the AI without waiting for the answer.
+ * Queries started this way run concurrently over a shared connection;
+ * setting *cancel (if not NULL) abandons one.
+ * Returns 0 if started, -1 otherwise, in which case done is not called.
+ */
+int jshell_ai_chat_async(const char *query, const atomic_bool *cancel,
+                         JShellAIDoneFn done, void *ctx);
+
 /**
  * Send an execute query to the AI.
  * The AI will generate a valid jshell command based on the query.
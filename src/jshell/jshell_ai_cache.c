@@ -0,0 +1,820 @@
+/**
+ * @file jshell_ai_cache.c
+ * @brief Memoization of AI-generated commands.
+ *
+ * Agents repeat the same intents, and each @!query costs a round trip to
+ * the API measured in seconds. Generated commands are kept in a small LRU
+ * for the session and appended to ~/.jshell/ai-cache, one line per entry:
+ *
+ *   <time> <fingerprint> <normalized query>\t<command>
+ *
+ * A later line for the same key supersedes an earlier one. Appends are a
+ * single write() on an O_APPEND descriptor, so concurrent shells do not
+ * interleave lines; once the file grows past AI_CACHE_FILE_MAX it is
+ * rewritten with only its newest unexpired lines.
+ *
+ * A query worded differently from any cached one is compared with each by
+ * a MinHash signature of the trigrams of its words, computed as they are
+ * scanned: with the session's few entries and a file of some thousand
+ * lines that takes a millisecond or two, against seconds for the API.
+ */
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "jshell_ai_cache.h"
+#include "utils/jbox_utils.h"
+
+
+#define AI_CACHE_SUBPATH "/.jshell/ai-cache"
+
+/** Hashes in the MinHash signature of a query */
+#define AI_MINHASH_SIZE 32
+
+/** Longest word compared; longer ones are cut */
+#define AI_WORD_MAX 31
+
+/** Literal tokens of a query taken into account */
+#define AI_LITERALS_MAX 32
+
+/** Sentence punctuation around a token */
+#define AI_PUNCTUATION ".,;:!?\"'()"
+
+
+/** Words that do not change what a query asks for */
+static const char* const FILLER_WORDS[] = {
+  "a", "all", "an", "and", "are", "as", "at", "be", "by", "can", "could",
+  "current", "do", "for", "from", "give", "here", "i", "in", "into", "is",
+  "it", "me", "my", "of", "on", "or", "please", "some", "that", "the",
+  "them", "then", "there", "this", "to", "want", "we", "with", "you",
+  "your", NULL
+};
+
+
+/** Words folded into one of the same meaning, singular */
+static const char* const SYNONYMS[][2] = {
+  { "show", "list" },
+  { "display", "list" },
+  { "remove", "delete" },
+  { "erase", "delete" },
+  { "dir", "directory" },
+  { "folder", "directory" },
+  { NULL, NULL }
+};
+
+
+/** What a query is compared by */
+typedef struct {
+  uint64_t signature[AI_MINHASH_SIZE];  /* Least trigram hash, per seed */
+  uint64_t literals;    /* Hash of its distinct non-word tokens */
+  int words;            /* Words left once fillers are dropped */
+} AIQueryShape;
+
+
+/** A cached query and its generated command */
+typedef struct AICacheEntry {
+  char* query;          /* Normalized */
+  uint64_t fingerprint;
+  char* command;
+  time_t stored;
+  struct AICacheEntry* lru_prev;   /* Towards most recently used */
+  struct AICacheEntry* lru_next;   /* Towards least recently used */
+} AICacheEntry;
+
+
+/** Most and least recently used entries */
+static AICacheEntry* g_lru_head = NULL;
+static AICacheEntry* g_lru_tail = NULL;
+
+static size_t g_entry_count = 0;
+
+
+/**
+ * Get the path of the cache file.
+ * @return Allocated path, or NULL if there is no home directory.
+ */
+static char* cache_file_path(void) {
+  const char* home = getenv("HOME");
+  if (home == NULL || home[0] == '\0') {
+    struct passwd* pw = getpwuid(getuid());
+    home = pw != NULL ? pw->pw_dir : NULL;
+  }
+  if (home == NULL) {
+    return NULL;
+  }
+
+  size_t len = strlen(home) + strlen(AI_CACHE_SUBPATH) + 1;
+  char* path = malloc(len);
+  if (path != NULL) {
+    snprintf(path, len, "%s%s", home, AI_CACHE_SUBPATH);
+  }
+  return path;
+}
+
+
+/**
+ * Normalize a query: lowercase, surrounding whitespace dropped and inner
+ * runs of whitespace collapsed to one space.
+ * @param query Query text.
+ * @return Allocated normalized query, or NULL if out of memory.
+ */
+static char* normalize_query(const char* query) {
+  char* norm = malloc(strlen(query) + 1);
+  if (norm == NULL) {
+    return NULL;
+  }
+
+  size_t len = 0;
+  for (const unsigned char* p = (const unsigned char*)query; *p; p++) {
+    if (isspace(*p)) {
+      if (len > 0 && norm[len - 1] != ' ') {
+        norm[len++] = ' ';
+      }
+    } else {
+      norm[len++] = (char)tolower(*p);
+    }
+  }
+  if (len > 0 && norm[len - 1] == ' ') {
+    len--;
+  }
+  norm[len] = '\0';
+  return norm;
+}
+
+
+/**
+ * Unlink an entry from the LRU list.
+ * @param entry Entry to unlink.
+ */
+static void lru_unlink(AICacheEntry* entry) {
+  if (entry->lru_prev != NULL) {
+    entry->lru_prev->lru_next = entry->lru_next;
+  } else {
+    g_lru_head = entry->lru_next;
+  }
+  if (entry->lru_next != NULL) {
+    entry->lru_next->lru_prev = entry->lru_prev;
+  } else {
+    g_lru_tail = entry->lru_prev;
+  }
+  entry->lru_prev = NULL;
+  entry->lru_next = NULL;
+}
+
+
+/**
+ * Insert an entry at the most recently used end of the LRU list.
+ * @param entry Entry to insert.
+ */
+static void lru_push_front(AICacheEntry* entry) {
+  entry->lru_prev = NULL;
+  entry->lru_next = g_lru_head;
+  if (g_lru_head != NULL) {
+    g_lru_head->lru_prev = entry;
+  }
+  g_lru_head = entry;
+  if (g_lru_tail == NULL) {
+    g_lru_tail = entry;
+  }
+}
+
+
+/**
+ * Unlink and free an entry.
+ * @param entry Entry to remove.
+ */
+static void remove_entry(AICacheEntry* entry) {
+  lru_unlink(entry);
+  free(entry->query);
+  free(entry->command);
+  free(entry);
+  g_entry_count--;
+}
+
+
+/**
+ * Find a session entry.
+ * @param query Normalized query.
+ * @param fingerprint Context fingerprint.
+ * @return The entry, or NULL.
+ */
+static AICacheEntry* find_entry(const char* query, uint64_t fingerprint) {
+  for (AICacheEntry* entry = g_lru_head; entry != NULL;
+       entry = entry->lru_next) {
+    if (entry->fingerprint == fingerprint
+        && strcmp(entry->query, query) == 0) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+
+/**
+ * Add or replace a session entry, evicting the least recently used one
+ * when full.
+ * @param query Normalized query.
+ * @param fingerprint Context fingerprint.
+ * @param command Generated command.
+ * @param stored When the command was generated.
+ */
+static void remember(const char* query, uint64_t fingerprint,
+                     const char* command, time_t stored) {
+  AICacheEntry* old = find_entry(query, fingerprint);
+  if (old != NULL) {
+    remove_entry(old);
+  }
+
+  AICacheEntry* entry = calloc(1, sizeof(AICacheEntry));
+  char* query_copy = strdup(query);
+  char* command_copy = strdup(command);
+  if (entry == NULL || query_copy == NULL || command_copy == NULL) {
+    free(entry);
+    free(query_copy);
+    free(command_copy);
+    return;
+  }
+
+  if (g_entry_count >= AI_CACHE_CAPACITY) {
+    remove_entry(g_lru_tail);
+  }
+
+  entry->query = query_copy;
+  entry->fingerprint = fingerprint;
+  entry->command = command_copy;
+  entry->stored = stored;
+  lru_push_front(entry);
+  g_entry_count++;
+}
+
+
+/**
+ * Split a cache file line into its fields, in place.
+ * @param line Line without its newline.
+ * @param stored Set to the entry's time.
+ * @param fingerprint Set to the entry's fingerprint.
+ * @param query Set to the normalized query.
+ * @param command Set to the command.
+ * @return 1 if the line is well formed, 0 otherwise.
+ */
+static int parse_line(char* line, time_t* stored, uint64_t* fingerprint,
+                      char** query, char** command) {
+  long long when;
+  unsigned long long fp;
+  int offset = 0;
+  if (sscanf(line, "%lld %llx %n", &when, &fp, &offset) != 2
+      || offset == 0) {
+    return 0;
+  }
+
+  char* tab = strchr(line + offset, '\t');
+  if (tab == NULL) {
+    return 0;
+  }
+  *tab = '\0';
+  *stored = (time_t)when;
+  *fingerprint = (uint64_t)fp;
+  *query = line + offset;
+  *command = tab + 1;
+  return 1;
+}
+
+
+/**
+ * Rewrite the cache file with only its newest unexpired lines, up to half
+ * of AI_CACHE_FILE_MAX.
+ * @param path Cache file path.
+ * @param now Current time.
+ */
+static void compact_file(const char* path, time_t now) {
+  FILE* in = fopen(path, "r");
+  if (in == NULL) {
+    return;
+  }
+
+  char** lines = NULL;
+  size_t count = 0;
+  size_t cap = 0;
+  char* line = NULL;
+  size_t line_cap = 0;
+  ssize_t len;
+  while ((len = getline(&line, &line_cap, in)) != -1) {
+    long long when;
+    if (sscanf(line, "%lld", &when) != 1
+        || now - (time_t)when >= AI_CACHE_TTL || line[len - 1] != '\n') {
+      continue;
+    }
+    if (count == cap) {
+      cap = cap ? cap * 2 : 256;
+      char** grown = realloc(lines, cap * sizeof(char*));
+      if (grown == NULL) {
+        break;
+      }
+      lines = grown;
+    }
+    lines[count] = strdup(line);
+    if (lines[count] == NULL) {
+      break;
+    }
+    count++;
+  }
+  free(line);
+  fclose(in);
+
+  /* Keep the newest lines that fit */
+  size_t first = count;
+  size_t kept = 0;
+  while (first > 0
+         && kept + strlen(lines[first - 1]) <= AI_CACHE_FILE_MAX / 2) {
+    kept += strlen(lines[--first]);
+  }
+
+  size_t tmp_len = strlen(path) + 32;
+  char* tmp_path = malloc(tmp_len);
+  FILE* out = NULL;
+  if (tmp_path != NULL) {
+    snprintf(tmp_path, tmp_len, "%s.%ld.tmp", path, (long)getpid());
+    out = fopen(tmp_path, "w");
+  }
+  if (out != NULL) {
+    for (size_t i = first; i < count; i++) {
+      fputs(lines[i], out);
+    }
+    if (fclose(out) != 0 || rename(tmp_path, path) != 0) {
+      unlink(tmp_path);
+    }
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    free(lines[i]);
+  }
+  free(lines);
+  free(tmp_path);
+}
+
+
+/**
+ * Return the command cached for a query.
+ *
+ * Looks in the session entries first, then in ~/.jshell/ai-cache, where
+ * another session may have stored it.
+ *
+ * @param query Query text as typed.
+ * @param fingerprint Fingerprint of the model, context and commands.
+ * @return Allocated command, or NULL on a miss or expired entry.
+ */
+char* jshell_ai_cache_get(const char* query, uint64_t fingerprint) {
+  char* norm = normalize_query(query);
+  if (norm == NULL) {
+    return NULL;
+  }
+
+  time_t now = time(NULL);
+  char* result = NULL;
+
+  AICacheEntry* entry = find_entry(norm, fingerprint);
+  if (entry != NULL && now - entry->stored < AI_CACHE_TTL) {
+    lru_unlink(entry);
+    lru_push_front(entry);
+    result = strdup(entry->command);
+    DPRINT("AI cache hit: %s", norm);
+    free(norm);
+    return result;
+  }
+  if (entry != NULL) {
+    remove_entry(entry);
+  }
+
+  char* path = cache_file_path();
+  FILE* in = path != NULL ? fopen(path, "r") : NULL;
+  free(path);
+  if (in != NULL) {
+    char* line = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+    time_t found_at = 0;
+    while ((len = getline(&line, &line_cap, in)) != -1) {
+      if (len > 0 && line[len - 1] == '\n') {
+        line[--len] = '\0';
+      }
+
+      time_t stored;
+      uint64_t fp;
+      char* line_query;
+      char* command;
+      if (parse_line(line, &stored, &fp, &line_query, &command)
+          && fp == fingerprint && now - stored < AI_CACHE_TTL
+          && strcmp(line_query, norm) == 0) {
+        free(result);
+        result = strdup(command);
+        found_at = stored;
+      }
+    }
+    free(line);
+    fclose(in);
+
+    if (result != NULL) {
+      DPRINT("AI cache file hit: %s", norm);
+      remember(norm, fingerprint, result, found_at);
+    }
+  }
+
+  free(norm);
+  return result;
+}
+
+
+/**
+ * Hash bytes with FNV-1a.
+ * @param data Bytes to hash.
+ * @param len Number of bytes.
+ * @param hash Hash so far, or the FNV offset basis.
+ * @return Updated hash.
+ */
+static uint64_t hash_bytes(const char* data, size_t len, uint64_t hash) {
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (unsigned char)data[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+
+/**
+ * Scramble a hash (the splitmix64 finalizer), one independent hash
+ * function per seed.
+ * @param hash Trigram hash.
+ * @param seed Index of the hash function.
+ * @return Scrambled hash.
+ */
+static uint64_t minhash_mix(uint64_t hash, int seed) {
+  uint64_t x = hash + (uint64_t)(seed + 1) * 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+
+/**
+ * Add the trigrams of a word, padded with a space on each side, to a
+ * signature.
+ * @param shape Shape being built.
+ * @param word Canonical word.
+ */
+static void shape_add_word(AIQueryShape* shape, const char* word) {
+  char padded[AI_WORD_MAX + 3];
+  int len = snprintf(padded, sizeof(padded), " %.*s ", AI_WORD_MAX, word);
+  for (int i = 0; i + 3 <= len; i++) {
+    uint64_t hash = hash_bytes(padded + i, 3, 0xcbf29ce484222325ULL);
+    for (int k = 0; k < AI_MINHASH_SIZE; k++) {
+      uint64_t value = minhash_mix(hash, k);
+      if (value < shape->signature[k]) {
+        shape->signature[k] = value;
+      }
+    }
+  }
+  shape->words++;
+}
+
+
+/**
+ * Look a word up in a NULL-terminated list.
+ * @return 1 if it is there, 0 otherwise.
+ */
+static int word_in(const char* word, const char* const* list) {
+  for (size_t i = 0; list[i] != NULL; i++) {
+    if (strcmp(word, list[i]) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+/**
+ * Order C strings, for qsort().
+ */
+static int compare_strings(const void* a, const void* b) {
+  return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+
+/**
+ * Work out what a normalized query is compared by.
+ *
+ * Plain words (letters, '-' and '_') lose fillers and a plural "s" and
+ * have synonyms folded; "this dir" and "current directory" mean "here",
+ * itself a filler. Every other token is a literal, kept as written.
+ *
+ * @param norm Normalized query.
+ * @param shape Filled in.
+ * @return Number of words in the signature; 0 if there is nothing to
+ *         compare, or out of memory.
+ */
+static int query_shape(const char* norm, AIQueryShape* shape) {
+  memset(shape, 0, sizeof(*shape));
+  for (int k = 0; k < AI_MINHASH_SIZE; k++) {
+    shape->signature[k] = UINT64_MAX;
+  }
+
+  char* copy = strdup(norm);
+  if (copy == NULL) {
+    return 0;
+  }
+
+  const char* literals[AI_LITERALS_MAX];
+  size_t literal_count = 0;
+  bool after_here = false;
+  char* save = NULL;
+  for (char* tok = strtok_r(copy, " ", &save); tok != NULL;
+       tok = strtok_r(NULL, " ", &save)) {
+    while (*tok != '\0' && strchr(AI_PUNCTUATION, *tok) != NULL) {
+      tok++;
+    }
+    size_t len = strlen(tok);
+    while (len > 0 && strchr(AI_PUNCTUATION, tok[len - 1]) != NULL) {
+      tok[--len] = '\0';
+    }
+    if (len == 0) {
+      continue;
+    }
+
+    bool plain = true;
+    for (size_t i = 0; i < len && plain; i++) {
+      plain = islower((unsigned char)tok[i]) || tok[i] == '-'
+              || tok[i] == '_';
+    }
+    if (!plain) {
+      if (literal_count < AI_LITERALS_MAX) {
+        literals[literal_count++] = tok;
+      }
+      after_here = false;
+      continue;
+    }
+
+    if (word_in(tok, FILLER_WORDS)) {
+      if (strcmp(tok, "this") == 0 || strcmp(tok, "current") == 0) {
+        after_here = true;
+      }
+      continue;
+    }
+    if (len > 3 && tok[len - 1] == 's' && tok[len - 2] != 's') {
+      tok[--len] = '\0';
+    }
+    const char* word = tok;
+    for (size_t i = 0; SYNONYMS[i][0] != NULL; i++) {
+      if (strcmp(word, SYNONYMS[i][0]) == 0) {
+        word = SYNONYMS[i][1];
+        break;
+      }
+    }
+    if (after_here && strcmp(word, "directory") == 0) {
+      after_here = false;
+      continue;
+    }
+    after_here = false;
+    shape_add_word(shape, word);
+  }
+
+  /* Order and repetition of literals do not matter, their text does */
+  qsort(literals, literal_count, sizeof(char*), compare_strings);
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < literal_count; i++) {
+    if (i > 0 && strcmp(literals[i], literals[i - 1]) == 0) {
+      continue;
+    }
+    hash = hash_bytes(literals[i], strlen(literals[i]) + 1, hash);
+  }
+  shape->literals = hash;
+
+  free(copy);
+  return shape->words;
+}
+
+
+/**
+ * Estimate how alike two queries are.
+ * @param a Shape of one query.
+ * @param b Shape of the other.
+ * @return Share of signature hashes in common, an estimate of the Jaccard
+ *         similarity of their trigrams; 0 if their literals differ.
+ */
+static double shape_similarity(const AIQueryShape* a,
+                               const AIQueryShape* b) {
+  if (a->words == 0 || b->words == 0 || a->literals != b->literals) {
+    return 0.0;
+  }
+  int same = 0;
+  for (int k = 0; k < AI_MINHASH_SIZE; k++) {
+    same += a->signature[k] == b->signature[k];
+  }
+  return (double)same / AI_MINHASH_SIZE;
+}
+
+
+/** The most similar cached query found so far */
+typedef struct {
+  double score;
+  char* query;
+  char* command;
+  time_t stored;
+} AISimilarMatch;
+
+
+/**
+ * Make a candidate the best match if it is alike enough and beats it.
+ * @param best Best match so far.
+ * @param shape Shape of the query looked up.
+ * @param query Candidate's normalized query.
+ * @param command Candidate's command.
+ * @param stored When the candidate was generated.
+ * @param on_tie Whether to take the candidate over an equal match.
+ */
+static void consider_match(AISimilarMatch* best, const AIQueryShape* shape,
+                           const char* query, const char* command,
+                           time_t stored, bool on_tie) {
+  AIQueryShape other;
+  if (query_shape(query, &other) == 0) {
+    return;
+  }
+  double score = shape_similarity(shape, &other);
+  if (score < AI_CACHE_SIMILARITY
+      || (best->command != NULL
+          && (score < best->score || (score == best->score && !on_tie)))) {
+    return;
+  }
+
+  char* query_copy = strdup(query);
+  char* command_copy = strdup(command);
+  if (query_copy == NULL || command_copy == NULL) {
+    free(query_copy);
+    free(command_copy);
+    return;
+  }
+  free(best->query);
+  free(best->command);
+  best->score = score;
+  best->query = query_copy;
+  best->command = command_copy;
+  best->stored = stored;
+}
+
+
+/**
+ * Return the command cached for the query most like this one.
+ *
+ * Compares with every unexpired session entry and line of
+ * ~/.jshell/ai-cache under the same fingerprint; the session's most
+ * recent entry and the file's latest line win ties. The command found is
+ * then also remembered for this wording, for the session.
+ *
+ * @param query Query text as typed.
+ * @param fingerprint Fingerprint of the model, context and commands.
+ * @param accept Last check of the command, or NULL.
+ * @param matched Set to the cached query on a hit, if not NULL.
+ * @return Allocated command, or NULL if none is alike enough.
+ */
+char* jshell_ai_cache_get_similar(const char* query, uint64_t fingerprint,
+                                  int (*accept)(const char* command),
+                                  char** matched) {
+  char* norm = normalize_query(query);
+  AIQueryShape shape;
+  if (norm == NULL || query_shape(norm, &shape) == 0) {
+    free(norm);
+    return NULL;
+  }
+
+  time_t now = time(NULL);
+  AISimilarMatch best = { 0 };
+  for (AICacheEntry* entry = g_lru_head; entry != NULL;
+       entry = entry->lru_next) {
+    if (entry->fingerprint == fingerprint
+        && now - entry->stored < AI_CACHE_TTL) {
+      consider_match(&best, &shape, entry->query, entry->command,
+                     entry->stored, false);
+    }
+  }
+
+  char* path = cache_file_path();
+  FILE* in = path != NULL ? fopen(path, "r") : NULL;
+  free(path);
+  if (in != NULL) {
+    char* line = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &line_cap, in)) != -1) {
+      if (len > 0 && line[len - 1] == '\n') {
+        line[--len] = '\0';
+      }
+
+      time_t stored;
+      uint64_t fp;
+      char* line_query;
+      char* command;
+      if (parse_line(line, &stored, &fp, &line_query, &command)
+          && fp == fingerprint && now - stored < AI_CACHE_TTL) {
+        consider_match(&best, &shape, line_query, command, stored, true);
+      }
+    }
+    free(line);
+    fclose(in);
+  }
+
+  if (best.command != NULL && accept != NULL && !accept(best.command)) {
+    DPRINT("AI cache similar command rejected: %s", best.command);
+    free(best.command);
+    best.command = NULL;
+  }
+  if (best.command != NULL) {
+    DPRINT("AI cache similar hit (%.2f): %s ~ %s", best.score, norm,
+           best.query);
+    remember(norm, fingerprint, best.command, best.stored);
+    if (matched != NULL) {
+      *matched = best.query;
+      best.query = NULL;
+    }
+  }
+
+  free(best.query);
+  free(norm);
+  return best.command;
+}
+
+
+/**
+ * Remember a generated command.
+ *
+ * Commands spanning several lines or holding tabs are only kept for the
+ * session, since they do not fit the file's line format.
+ *
+ * @param query Query text as typed.
+ * @param fingerprint Fingerprint of the model, context and commands.
+ * @param command Generated command.
+ */
+void jshell_ai_cache_put(const char* query, uint64_t fingerprint,
+                         const char* command) {
+  char* norm = normalize_query(query);
+  if (norm == NULL || norm[0] == '\0' || command == NULL) {
+    free(norm);
+    return;
+  }
+
+  time_t now = time(NULL);
+  remember(norm, fingerprint, command, now);
+
+  char* path = cache_file_path();
+  if (path == NULL || strpbrk(command, "\t\n") != NULL) {
+    free(path);
+    free(norm);
+    return;
+  }
+
+  char* line = NULL;
+  size_t line_size = 0;
+  FILE* buf = open_memstream(&line, &line_size);
+  if (buf != NULL) {
+    fprintf(buf, "%lld %016llx %s\t%s\n", (long long)now,
+            (unsigned long long)fingerprint, norm, command);
+    fclose(buf);
+  }
+
+  /* ~/.jshell is normally made at startup; make it if it is missing */
+  char* slash = strrchr(path, '/');
+  *slash = '\0';
+  mkdir(path, 0700);
+  *slash = '/';
+
+  int fd = line != NULL
+           ? open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600)
+           : -1;
+  if (fd >= 0) {
+    struct stat st;
+    if (write(fd, line, line_size) == (ssize_t)line_size
+        && fstat(fd, &st) == 0 && st.st_size > AI_CACHE_FILE_MAX) {
+      compact_file(path, now);
+    }
+    close(fd);
+  }
+
+  free(line);
+  free(path);
+  free(norm);
+}
+
+
+/**
+ * Free all session entries. The cache file is left as it is.
+ */
+void jshell_ai_cache_clear(void) {
+  while (g_lru_head != NULL) {
+    remove_entry(g_lru_head);
+  }
+}
@@ -0,0 +1,54 @@
+#ifndef JSHELL_AI_CACHE_H
+#define JSHELL_AI_CACHE_H
+
+#include <stdint.h>
+
+
+// Maximum number of generated commands kept in memory
+#define AI_CACHE_CAPACITY 64
+
+// Seconds a generated command is reused before asking the AI again
+#define AI_CACHE_TTL (7 * 24 * 60 * 60)
+
+// Size past which ~/.jshell/ai-cache is rewritten without expired entries
+#define AI_CACHE_FILE_MAX (256 * 1024)
+
+// Estimated share of trigrams two differently worded queries must have in
+// common for the command of one to answer the other
+#define AI_CACHE_SIMILARITY 0.8
+
+
+// Memoization of AI-generated commands (@!query)
+//
+// Queries are normalized (lowercased, whitespace collapsed) and keyed
+// together with a fingerprint of everything else the answer depends on:
+// the model, the prompt context and the registered commands. Entries live
+// in a session LRU and in ~/.jshell/ai-cache, one line each, so identical
+// intents resolve without a round trip across sessions too.
+//
+// Near-duplicates ("list json files here", "show json files in this dir")
+// are found by MinHash over the trigrams of their words, once filler words
+// are dropped and a few synonyms folded. Tokens that are not plain words
+// (file names, numbers, globs) must be the same in both queries.
+
+// Return the command cached for query under fingerprint, or NULL on a miss
+// Caller must free the returned string
+char* jshell_ai_cache_get(const char* query, uint64_t fingerprint);
+
+// Return the command cached under fingerprint for the query most like
+// query, if at least AI_CACHE_SIMILARITY alike and accept (if not NULL)
+// returns nonzero for it; sets *matched to that query (caller frees)
+// Caller must free the returned string
+char* jshell_ai_cache_get_similar(const char* query, uint64_t fingerprint,
+                                  int (*accept)(const char* command),
+                                  char** matched);
+
+// Remember command as the answer to query under fingerprint
+void jshell_ai_cache_put(const char* query, uint64_t fingerprint,
+                         const char* command);
+
+// Free the session entries (the file is kept)
+void jshell_ai_cache_clear(void);
+
+
+#endif
@@ -8,8 +8,10 @@
  *
  * Context files:
  * - exec_context.txt: Instructions for AI command generation
- * - cmd_context.txt: Documentation for all available commands
  * - grammar_context.txt: Shell grammar and syntax specification
+ *
+ * The command list is not embedded: it is rendered from the command
+ * registry at runtime so packages and new builtins are always covered.
  */
 
 #include "jshell_ai_context.h"
@@ -22,12 +24,6 @@ const char EXEC_INSTRUCTIONS[] = {
   , '\0'
 };
 
-/** Command documentation and usage information */
-const char CMD_CONTEXT[] = {
-  #embed "ai_context/cmd_context.txt"
-  , '\0'
-};
-
 /** Shell grammar and syntax specification */
 const char GRAMMAR_CONTEXT[] = {
   #embed "ai_context/grammar_context.txt"
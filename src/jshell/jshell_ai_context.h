@@ -9,9 +9,6 @@
 /* Instructions for AI exec queries */
 extern const char EXEC_INSTRUCTIONS[];
 
-/* Command help text for all available commands */
-extern const char CMD_CONTEXT[];
-
 /* Shell grammar specification */
 extern const char GRAMMAR_CONTEXT[];
 
@@ -1,15 +1,23 @@
 /**
  * @file jshell_cmd_registry.c
  * @brief Command registry for tracking and managing shell commands
+ *
+ * Lookups also come from worker threads (xargs, parallel, pipeline
+ * stages), and a lookup miss may register commands through the loader, so
+ * every entry point holds registry_lock. The lock is recursive because the
+ * loader's callbacks register commands and so call back into the registry.
  */
 
+#define _GNU_SOURCE
+#include <pthread.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "jshell_cmd_registry.h"
 
-#define MAX_COMMANDS 128
+#define INITIAL_REGISTRY_CAPACITY 64
+#define INITIAL_INDEX_CAPACITY 128
 
 /** Registry entry that tracks whether the spec was dynamically allocated */
 typedef struct {
@@ -17,12 +25,184 @@ typedef struct {
   int is_dynamic;  /* 1 if spec was allocated by register_package_command */
 } RegistryEntry;
 
-/** Array of registered commands */
-static RegistryEntry command_registry[MAX_COMMANDS];
+/** Guards everything below; recursive, see the file comment */
+static pthread_mutex_t registry_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+/** Growable array of registered commands, kept in registration order */
+static RegistryEntry *command_registry;
 
 /** Number of currently registered commands */
 static size_t command_count;
 
+/** Allocated length of command_registry */
+static size_t command_capacity;
+
+/**
+ * Open-addressing hash index over command_registry keyed by command name.
+ * Each slot holds (entry index + 1), so 0 marks an empty slot. The capacity
+ * is always a power of two and kept at least twice command_count, which
+ * bounds linear probe sequences.
+ */
+static size_t *command_index;
+
+/** Number of slots in command_index */
+static size_t index_capacity;
+
+/** Loader consulted on lookup misses, or NULL */
+static const jshell_cmd_loader_t *command_loader;
+
+/** True until command_loader->load_all has run */
+static int load_all_pending;
+
+/** Bumped whenever a command is registered or unregistered */
+static unsigned long registry_generation;
+
+
+static const jshell_cmd_spec_t *lookup_command(const char *name);
+
+
+/**
+ * Hash a command name with 64-bit FNV-1a.
+ * @param name NUL-terminated command name
+ * @return Hash value
+ */
+static size_t hash_command_name(const char *name) {
+  size_t hash = (size_t)14695981039346656037ULL;
+  for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+    hash ^= *p;
+    hash *= (size_t)1099511628211ULL;
+  }
+  return hash;
+}
+
+
+/**
+ * Locate the index slot for a command name.
+ * @param name Command name to look up
+ * @return Slot holding the name, or the empty slot where it would be
+ *         inserted. Only valid while index_capacity > 0.
+ */
+static size_t find_index_slot(const char *name) {
+  size_t mask = index_capacity - 1;
+  size_t slot = hash_command_name(name) & mask;
+
+  while (command_index[slot] != 0) {
+    const jshell_cmd_spec_t *spec = command_registry[command_index[slot] - 1]
+                                      .spec;
+    if (strcmp(spec->name, name) == 0) {
+      break;
+    }
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+
+/**
+ * Add a registry entry to the hash index.
+ * If a command with the same name is already indexed the earlier entry
+ * keeps precedence, matching first-registered-wins lookup semantics.
+ * @param entry_idx Index into command_registry
+ */
+static void index_insert(size_t entry_idx) {
+  const char *name = command_registry[entry_idx].spec->name;
+  size_t slot = find_index_slot(name);
+  if (command_index[slot] == 0) {
+    command_index[slot] = entry_idx + 1;
+  }
+}
+
+
+/**
+ * Repopulate the hash index from command_registry in place.
+ * Needed after entries are removed, since removal compacts the registry
+ * and shifts entry indices.
+ */
+static void reindex_all(void) {
+  if (index_capacity == 0) {
+    return;
+  }
+  memset(command_index, 0, index_capacity * sizeof(size_t));
+  for (size_t i = 0; i < command_count; i++) {
+    index_insert(i);
+  }
+}
+
+
+/**
+ * Replace the hash index with a larger one.
+ * @param new_capacity Slot count for the new index (power of two)
+ * @return 0 on success, -1 on allocation failure (old index is kept)
+ */
+static int grow_index(size_t new_capacity) {
+  size_t *new_index = calloc(new_capacity, sizeof(size_t));
+  if (new_index == NULL) {
+    return -1;
+  }
+
+  free(command_index);
+  command_index = new_index;
+  index_capacity = new_capacity;
+  reindex_all();
+  return 0;
+}
+
+
+/**
+ * Ensure there is room for one more command in the registry and index.
+ * @return 0 on success, -1 on allocation failure
+ */
+static int reserve_entry(void) {
+  if (command_count == command_capacity) {
+    size_t new_capacity = command_capacity ? command_capacity * 2
+                                           : INITIAL_REGISTRY_CAPACITY;
+    RegistryEntry *grown = realloc(command_registry,
+                                   new_capacity * sizeof(RegistryEntry));
+    if (grown == NULL) {
+      return -1;
+    }
+    command_registry = grown;
+    command_capacity = new_capacity;
+  }
+
+  if ((command_count + 1) * 2 > index_capacity) {
+    size_t new_capacity = index_capacity ? index_capacity * 2
+                                         : INITIAL_INDEX_CAPACITY;
+    if (grow_index(new_capacity) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+
+/**
+ * Append a spec to the registry and index it.
+ * reserve_entry() must have succeeded beforehand.
+ * @param spec Command spec to append
+ * @param is_dynamic 1 if the spec was allocated by the registry
+ */
+static void append_entry(const jshell_cmd_spec_t *spec, int is_dynamic) {
+  command_registry[command_count].spec = spec;
+  command_registry[command_count].is_dynamic = is_dynamic;
+  index_insert(command_count);
+  command_count++;
+  registry_generation++;
+}
+
+
+/**
+ * Let the loader register everything before the registry is listed.
+ * The pending flag is cleared first, since load_all registers commands
+ * and so calls back into the registry.
+ */
+static void run_load_all(void) {
+  if (command_loader != NULL && load_all_pending) {
+    load_all_pending = 0;
+    command_loader->load_all();
+  }
+}
+
 
 /**
  * Register a command specification in the registry.
@@ -31,46 +211,32 @@ static size_t command_count;
  * @param spec Pointer to command specification (must not be NULL)
  */
 void jshell_register_command(const jshell_cmd_spec_t *spec) {
-  if (spec == NULL) {
+  if (spec == NULL || spec->name == NULL) {
     return;
   }
-  if (command_count < MAX_COMMANDS) {
-    command_registry[command_count].spec = spec;
-    command_registry[command_count].is_dynamic = 0;
-    command_count++;
+  pthread_mutex_lock(&registry_lock);
+  if (reserve_entry() == 0) {
+    append_entry(spec, 0);
   }
+  pthread_mutex_unlock(&registry_lock);
 }
 
 
 /**
- * Register a command from an installed package.
- * Creates a dynamically allocated command spec that will be freed when
- * the command is unregistered. Fails if the command name already exists.
- * @param name Name of the command (must not be NULL)
- * @param summary One-line description of the command (can be NULL)
- * @param bin_path Full path to the executable binary (must not be NULL)
- * @return 0 on success, -1 on failure (NULL params, registry full, or
- *         command already exists)
+ * Register a package command; see jshell_register_package_command().
+ * Called with registry_lock held.
+ * @return 0 on success, -1 on failure
  */
-int jshell_register_package_command(const char *name, const char *summary,
+static int register_package_command(const char *name, const char *summary,
                                     const char *bin_path) {
-  if (name == NULL || bin_path == NULL) {
-    return -1;
+  if (lookup_command(name) != NULL) {
+    return -1;  // Already registered
   }
 
-  if (command_count >= MAX_COMMANDS) {
+  if (reserve_entry() != 0) {
     return -1;
   }
 
-  // Check if command already exists
-  for (size_t i = 0; i < command_count; i++) {
-    if (command_registry[i].spec != NULL &&
-        command_registry[i].spec->name != NULL &&
-        strcmp(command_registry[i].spec->name, name) == 0) {
-      return -1;  // Already registered
-    }
-  }
-
   // Allocate new spec
   jshell_cmd_spec_t *spec = calloc(1, sizeof(jshell_cmd_spec_t));
   if (spec == NULL) {
@@ -93,14 +259,35 @@ int jshell_register_package_command(const char *name, const char *summary,
     return -1;
   }
 
-  command_registry[command_count].spec = spec;
-  command_registry[command_count].is_dynamic = 1;
-  command_count++;
+  append_entry(spec, 1);
 
   return 0;
 }
 
 
+/**
+ * Register a command from an installed package.
+ * Creates a dynamically allocated command spec that will be freed when
+ * the command is unregistered. Fails if the command name already exists.
+ * @param name Name of the command (must not be NULL)
+ * @param summary One-line description of the command (can be NULL)
+ * @param bin_path Full path to the executable binary (must not be NULL)
+ * @return 0 on success, -1 on failure (NULL params, allocation failure, or
+ *         command already exists)
+ */
+int jshell_register_package_command(const char *name, const char *summary,
+                                    const char *bin_path) {
+  if (name == NULL || bin_path == NULL) {
+    return -1;
+  }
+
+  pthread_mutex_lock(&registry_lock);
+  int result = register_package_command(name, summary, bin_path);
+  pthread_mutex_unlock(&registry_lock);
+  return result;
+}
+
+
 /**
  * Free a dynamically allocated command specification.
  * Frees all string fields and the spec structure itself.
@@ -118,10 +305,45 @@ static void free_dynamic_spec(jshell_cmd_spec_t *spec) {
 }
 
 
+/**
+ * Unregister a command; see jshell_unregister_command().
+ * Called with registry_lock held.
+ * @return 0 on success, -1 if command not found
+ */
+static int unregister_command(const char *name) {
+  if (index_capacity == 0) {
+    return -1;
+  }
+
+  size_t slot = find_index_slot(name);
+  if (command_index[slot] == 0) {
+    return -1;
+  }
+  size_t i = command_index[slot] - 1;
+
+  // Free if dynamically allocated
+  if (command_registry[i].is_dynamic) {
+    free_dynamic_spec((jshell_cmd_spec_t *)command_registry[i].spec);
+  }
+
+  // Shift remaining entries
+  for (size_t j = i; j < command_count - 1; j++) {
+    command_registry[j] = command_registry[j + 1];
+  }
+  command_count--;
+  registry_generation++;
+
+  reindex_all();
+
+  return 0;
+}
+
+
 /**
  * Unregister a command by name.
  * If the command was dynamically allocated (package command), frees the spec.
- * Compacts the registry by shifting remaining entries.
+ * Compacts the registry by shifting remaining entries and rebuilds the
+ * hash index.
  * @param name Name of the command to unregister (must not be NULL)
  * @return 0 on success, -1 if command not found or name is NULL
  */
@@ -130,27 +352,10 @@ int jshell_unregister_command(const char *name) {
     return -1;
   }
 
-  for (size_t i = 0; i < command_count; i++) {
-    if (command_registry[i].spec != NULL &&
-        command_registry[i].spec->name != NULL &&
-        strcmp(command_registry[i].spec->name, name) == 0) {
-
-      // Free if dynamically allocated
-      if (command_registry[i].is_dynamic) {
-        free_dynamic_spec((jshell_cmd_spec_t *)command_registry[i].spec);
-      }
-
-      // Shift remaining entries
-      for (size_t j = i; j < command_count - 1; j++) {
-        command_registry[j] = command_registry[j + 1];
-      }
-      command_count--;
-
-      return 0;
-    }
-  }
-
-  return -1;
+  pthread_mutex_lock(&registry_lock);
+  int result = unregister_command(name);
+  pthread_mutex_unlock(&registry_lock);
+  return result;
 }
 
 
@@ -160,6 +365,7 @@ int jshell_unregister_command(const char *name) {
  * the registry, preserving builtin and external commands.
  */
 void jshell_unregister_all_package_commands(void) {
+  pthread_mutex_lock(&registry_lock);
   size_t write_idx = 0;
 
   for (size_t read_idx = 0; read_idx < command_count; read_idx++) {
@@ -178,13 +384,49 @@ void jshell_unregister_all_package_commands(void) {
     }
   }
 
-  command_count = write_idx;
+  if (write_idx != command_count) {
+    command_count = write_idx;
+    registry_generation++;
+    reindex_all();
+  }
+  pthread_mutex_unlock(&registry_lock);
+}
+
+
+/**
+ * Set a loader for commands that are only registered when needed.
+ * Commands found without it (builtins) never pay for loading the rest.
+ * @param loader Loader with static lifetime, or NULL to remove it
+ */
+void jshell_set_command_loader(const jshell_cmd_loader_t *loader) {
+  pthread_mutex_lock(&registry_lock);
+  command_loader = loader;
+  load_all_pending = loader != NULL;
+  pthread_mutex_unlock(&registry_lock);
+}
+
+
+/**
+ * Look a command up in the hash index.
+ * @param name Name of the command to find
+ * @return Pointer to command spec if found, NULL otherwise
+ */
+static const jshell_cmd_spec_t *lookup_command(const char *name) {
+  if (index_capacity == 0) {
+    return NULL;
+  }
+  size_t slot = find_index_slot(name);
+  if (command_index[slot] == 0) {
+    return NULL;
+  }
+  return command_registry[command_index[slot] - 1].spec;
 }
 
 
 /**
  * Find a command specification by name.
- * Performs linear search through the registry.
+ * Looks the name up in the hash index in expected constant time. On a
+ * miss the loader may register the name, and the lookup is retried.
  * @param name Name of the command to find (must not be NULL)
  * @return Pointer to command spec if found, NULL otherwise
  */
@@ -192,14 +434,14 @@ const jshell_cmd_spec_t *jshell_find_command(const char *name) {
   if (name == NULL) {
     return NULL;
   }
-  for (size_t index = 0; index < command_count; ++index) {
-    const jshell_cmd_spec_t *spec = command_registry[index].spec;
-    if (spec != NULL && spec->name != NULL &&
-        strcmp(spec->name, name) == 0) {
-      return spec;
-    }
+  pthread_mutex_lock(&registry_lock);
+  const jshell_cmd_spec_t *spec = lookup_command(name);
+  if (spec == NULL && command_loader != NULL) {
+    command_loader->resolve(name);
+    spec = lookup_command(name);
   }
-  return NULL;
+  pthread_mutex_unlock(&registry_lock);
+  return spec;
 }
 
 
@@ -215,12 +457,28 @@ void jshell_for_each_command(
   if (callback == NULL) {
     return;
   }
-  for (size_t index = 0; index < command_count; ++index) {
-    const jshell_cmd_spec_t *spec = command_registry[index].spec;
-    if (spec != NULL) {
-      callback(spec, userdata);
+  // Callbacks print, and may block on a pipe whose reader needs the
+  // registry, so they run on a snapshot taken under the lock
+  pthread_mutex_lock(&registry_lock);
+  run_load_all();
+  size_t count = command_count;
+  const jshell_cmd_spec_t **specs = malloc((count ? count : 1)
+                                           * sizeof(*specs));
+  if (specs == NULL) {
+    pthread_mutex_unlock(&registry_lock);
+    return;
+  }
+  for (size_t index = 0; index < count; ++index) {
+    specs[index] = command_registry[index].spec;
+  }
+  pthread_mutex_unlock(&registry_lock);
+
+  for (size_t index = 0; index < count; ++index) {
+    if (specs[index] != NULL) {
+      callback(specs[index], userdata);
     }
   }
+  free(specs);
 }
 
 
@@ -229,5 +487,24 @@ void jshell_for_each_command(
  * @return Count of commands in the registry
  */
 int jshell_get_command_count(void) {
-  return (int)command_count;
+  pthread_mutex_lock(&registry_lock);
+  run_load_all();
+  int count = (int)command_count;
+  pthread_mutex_unlock(&registry_lock);
+  return count;
+}
+
+
+/**
+ * Get the registry's generation, which changes whenever a command is
+ * registered or unregistered. Anything derived from the set of commands
+ * can be cached under it.
+ * @return Current generation
+ */
+unsigned long jshell_get_registry_generation(void) {
+  pthread_mutex_lock(&registry_lock);
+  run_load_all();
+  unsigned long generation = registry_generation;
+  pthread_mutex_unlock(&registry_lock);
+  return generation;
 }
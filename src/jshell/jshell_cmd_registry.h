@@ -1,6 +1,7 @@
 #ifndef JSHELL_CMD_REGISTRY_H
 #define JSHELL_CMD_REGISTRY_H
 
+#include <stdbool.h>
 #include <stdio.h>
 
 typedef enum {
@@ -9,6 +10,19 @@ typedef enum {
   CMD_PACKAGE     // Fork/exec binary from ~/.jshell/bin/
 } jshell_cmd_type_t;
 
+// What the output of a command depends on besides its arguments, for
+// the result cache (jshell_result_cache.h): the files named by its
+// arg_file arguments, taken as given or with everything below them; a
+// run naming none lists the working directory
+typedef enum {
+  CMD_CACHE_NONE,   // Not cacheable: reads stdin, the clock, or writes
+  CMD_CACHE_FILES,  // The named files and the entries of named directories
+  CMD_CACHE_TREES   // Everything below the named paths
+} jshell_cmd_cache_t;
+
+// Receives a command's argtable3 table, ended by its arg_end entry
+typedef void (*jshell_argtable_visit_fn)(void **argtable, void *userdata);
+
 typedef struct jshell_cmd_spec {
   const char *name;
   const char *summary;
@@ -17,8 +31,22 @@ typedef struct jshell_cmd_spec {
   int (*run)(int argc, char **argv);   // NULL for CMD_PACKAGE
   void (*print_usage)(FILE *out);      // NULL for CMD_PACKAGE
   const char *bin_path;                // Path to binary for CMD_PACKAGE
+  bool reads_records;                  // Takes jbox_record.h records on
+                                       // stdin from in-process stages
+  void (*describe_args)(jshell_argtable_visit_fn visit, void *userdata);
+                                       // Builds the argtable, passes it to
+                                       // visit and frees it; NULL if none
+  jshell_cmd_cache_t (*cache_scope)(int argc, char **argv);
+                                       // How a run with these arguments
+                                       // may be cached; NULL if never
 } jshell_cmd_spec_t;
 
+// Source of commands registered on demand (packages)
+typedef struct {
+  void (*resolve)(const char *name);  // May register name after a miss
+  void (*load_all)(void);             // Registers everything, run once
+} jshell_cmd_loader_t;
+
 // Register a static command spec (builtins and externals)
 void jshell_register_command(const jshell_cmd_spec_t *spec);
 
@@ -34,6 +62,10 @@ int jshell_unregister_command(const char *name);
 // Unregister all package commands (CMD_PACKAGE type)
 void jshell_unregister_all_package_commands(void);
 
+// Defer registration of more commands: a lookup miss asks the loader to
+// resolve that name, and listing the registry loads everything first
+void jshell_set_command_loader(const jshell_cmd_loader_t *loader);
+
 // Find a command by name
 const jshell_cmd_spec_t *jshell_find_command(const char *name);
 
@@ -45,4 +77,7 @@ void jshell_for_each_command(
 // Get count of registered commands
 int jshell_get_command_count(void);
 
+// Get a counter that changes whenever commands are registered or removed
+unsigned long jshell_get_registry_generation(void);
+
 #endif
@@ -0,0 +1,853 @@
+/**
+ * @file jshell_completion.c
+ * @brief Tab completion of command names and file names.
+ *
+ * Command names come from a prefix trie over the command registry and the
+ * executables in each PATH directory. Every source keeps the names it
+ * contributed, and the trie counts how many sources provide each name, so
+ * when one source changes (the registry generation moves, PATH is edited,
+ * or a directory's mtime changes) only that source's names are removed and
+ * re-added. A completion then walks the typed prefix and collects the
+ * subtree, which does not depend on how many commands exist elsewhere.
+ *
+ * File names come from directory listings that are read once, classified
+ * by d_type (only symlinks and file systems without d_type cost a stat),
+ * and kept until the directory's mtime changes.
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "jshell_completion.h"
+#include "jshell_cmd_registry.h"
+#include "jshell_vars.h"
+#include "utils/jbox_utils.h"
+
+
+#define DIR_CACHE_SLOTS 8
+
+
+/** A trie node; node 0 is the root and 0 also means "no node" in links */
+typedef struct {
+  uint32_t first_child;
+  uint32_t next_sibling;      /* Siblings are sorted by byte */
+  uint32_t words;             /* Name references in this subtree */
+  uint32_t ends;              /* Sources providing the name ending here */
+  unsigned char c;
+} TrieNode;
+
+
+/** Names one source contributes to the trie */
+typedef struct {
+  char* dir;                  /* PATH directory, NULL for the registry */
+  struct timespec mtime;
+  bool scanned;
+  char** names;
+  size_t count;
+} CommandSource;
+
+
+/** A directory listing for file name completion */
+typedef struct {
+  char* path;
+  struct timespec mtime;
+  char** names;               /* Sorted; directories end in '/' */
+  size_t count;
+  unsigned long used;         /* For least recently used eviction */
+} DirListing;
+
+
+/** Growable list of names */
+typedef struct {
+  char** names;
+  size_t count;
+  size_t capacity;
+} NameList;
+
+
+static TrieNode* g_nodes = NULL;
+static size_t g_node_count = 0;
+static size_t g_node_capacity = 0;
+
+static CommandSource g_registry = {0};
+static unsigned long g_registry_generation = 0;
+
+static CommandSource* g_path_sources = NULL;
+static size_t g_path_source_count = 0;
+static char* g_path_value = NULL;
+static unsigned long g_vars_generation = 0;
+static bool g_index_built = false;
+
+static DirListing g_dir_cache[DIR_CACHE_SLOTS];
+static unsigned long g_dir_clock = 0;
+
+
+/**
+ * Append a copy of a name to a list.
+ * @param list List to grow.
+ * @param name Name to copy.
+ * @param len Length of name.
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int name_list_push(NameList* list, const char* name, size_t len) {
+  if (list->count == list->capacity) {
+    size_t capacity = list->capacity ? list->capacity * 2 : 64;
+    char** grown = realloc(list->names, capacity * sizeof(char*));
+    if (grown == NULL) {
+      return -1;
+    }
+    list->names = grown;
+    list->capacity = capacity;
+  }
+  char* copy = strndup(name, len);
+  if (copy == NULL) {
+    return -1;
+  }
+  list->names[list->count++] = copy;
+  return 0;
+}
+
+
+/**
+ * Free the names of a list.
+ * @param names Name array.
+ * @param count Number of names.
+ */
+static void free_names(char** names, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    free(names[i]);
+  }
+  free(names);
+}
+
+
+/**
+ * qsort() comparator for name arrays.
+ */
+static int compare_names(const void* a, const void* b) {
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+
+/**
+ * Allocate a trie node.
+ * @param c Byte the node stands for.
+ * @return Node index, or 0 on allocation failure.
+ */
+static uint32_t trie_new_node(unsigned char c) {
+  if (g_node_count == g_node_capacity) {
+    size_t capacity = g_node_capacity ? g_node_capacity * 2 : 1024;
+    TrieNode* grown = realloc(g_nodes, capacity * sizeof(TrieNode));
+    if (grown == NULL) {
+      return 0;
+    }
+    g_nodes = grown;
+    g_node_capacity = capacity;
+  }
+  if (g_node_count == 0) {
+    memset(&g_nodes[0], 0, sizeof(TrieNode));   /* The root */
+    g_node_count = 1;
+  }
+  uint32_t index = (uint32_t)g_node_count++;
+  memset(&g_nodes[index], 0, sizeof(TrieNode));
+  g_nodes[index].c = c;
+  return index;
+}
+
+
+/**
+ * Find (or create) the child of a node for a byte.
+ * @param parent Parent node index.
+ * @param c Byte.
+ * @param create Whether to add a missing child.
+ * @return Child index, or 0 if it does not exist (or allocation failed).
+ */
+static uint32_t trie_child(uint32_t parent, unsigned char c, bool create) {
+  uint32_t prev = 0;
+  uint32_t node = g_nodes[parent].first_child;
+  while (node != 0 && g_nodes[node].c < c) {
+    prev = node;
+    node = g_nodes[node].next_sibling;
+  }
+  if (node != 0 && g_nodes[node].c == c) {
+    return node;
+  }
+  if (!create) {
+    return 0;
+  }
+
+  uint32_t child = trie_new_node(c);   /* May move g_nodes */
+  if (child == 0) {
+    return 0;
+  }
+  g_nodes[child].next_sibling = node;
+  if (prev != 0) {
+    g_nodes[prev].next_sibling = child;
+  } else {
+    g_nodes[parent].first_child = child;
+  }
+  return child;
+}
+
+
+/**
+ * Add a reference to a name, creating its path.
+ * @param name Name to add.
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int trie_add(const char* name) {
+  if (g_node_count == 0 && trie_new_node(0) == 0) {
+    return -1;
+  }
+
+  /* Create the whole path first so a failure leaves the counts alone */
+  uint32_t node = 0;
+  for (const unsigned char* p = (const unsigned char*)name; *p; p++) {
+    node = trie_child(node, *p, true);
+    if (node == 0) {
+      return -1;
+    }
+  }
+
+  node = 0;
+  g_nodes[0].words++;
+  for (const unsigned char* p = (const unsigned char*)name; *p; p++) {
+    node = trie_child(node, *p, false);
+    g_nodes[node].words++;
+  }
+  g_nodes[node].ends++;
+  return 0;
+}
+
+
+/**
+ * Drop a reference to a name added by trie_add(). Nodes are kept, with
+ * zero counts, so they can be reused when the name comes back.
+ * @param name Name to remove.
+ */
+static void trie_remove(const char* name) {
+  if (g_node_count == 0) {
+    return;
+  }
+
+  uint32_t node = 0;
+  for (const unsigned char* p = (const unsigned char*)name; *p; p++) {
+    node = trie_child(node, *p, false);
+    if (node == 0) {
+      return;
+    }
+  }
+  if (g_nodes[node].ends == 0) {
+    return;
+  }
+
+  node = 0;
+  g_nodes[0].words--;
+  for (const unsigned char* p = (const unsigned char*)name; *p; p++) {
+    node = trie_child(node, *p, false);
+    g_nodes[node].words--;
+  }
+  g_nodes[node].ends--;
+}
+
+
+/**
+ * Replace the names a source contributes, updating the trie.
+ * @param source Source to update.
+ * @param names New names (ownership taken), or NULL.
+ * @param count Number of new names.
+ */
+static void source_set_names(CommandSource* source, char** names,
+                             size_t count) {
+  for (size_t i = 0; i < source->count; i++) {
+    trie_remove(source->names[i]);
+  }
+  free_names(source->names, source->count);
+
+  source->names = NULL;
+  source->count = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (trie_add(names[i]) != 0) {
+      /* Keep only the names that made it into the trie */
+      for (size_t j = i; j < count; j++) {
+        free(names[j]);
+      }
+      count = i;
+      break;
+    }
+  }
+  source->names = names;
+  source->count = count;
+}
+
+
+/**
+ * Release a PATH source and its names.
+ * @param source Source to release.
+ */
+static void source_free(CommandSource* source) {
+  source_set_names(source, NULL, 0);
+  free(source->dir);
+  source->dir = NULL;
+}
+
+
+/**
+ * Registry iteration callback collecting command names.
+ */
+static void collect_command(const jshell_cmd_spec_t* spec, void* userdata) {
+  NameList* list = userdata;
+  name_list_push(list, spec->name, strlen(spec->name));
+}
+
+
+/**
+ * Re-read the registry when commands were registered or removed.
+ */
+static void refresh_registry(void) {
+  unsigned long generation = jshell_get_registry_generation();
+  if (g_index_built && generation == g_registry_generation) {
+    return;
+  }
+
+  NameList list = {0};
+  jshell_for_each_command(collect_command, &list);
+  source_set_names(&g_registry, list.names, list.count);
+
+  /* Listing loads deferred commands, so read the generation afterwards */
+  g_registry_generation = jshell_get_registry_generation();
+  DPRINT("Completion: %zu registered commands", g_registry.count);
+}
+
+
+/**
+ * Read the executables of a directory into a source.
+ * @param source Source with dir set.
+ */
+static void scan_path_dir(CommandSource* source) {
+  NameList list = {0};
+  struct stat st;
+
+  source->scanned = true;
+  if (stat(source->dir, &st) != 0) {
+    memset(&source->mtime, 0, sizeof(source->mtime));
+    source_set_names(source, NULL, 0);
+    return;
+  }
+  source->mtime = st.st_mtim;
+
+  DIR* dir = opendir(source->dir);
+  if (dir == NULL) {
+    source_set_names(source, NULL, 0);
+    return;
+  }
+
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] == '.' || entry->d_type == DT_DIR) {
+      continue;
+    }
+    if (faccessat(dirfd(dir), entry->d_name, X_OK, 0) != 0) {
+      continue;
+    }
+    if (entry->d_type != DT_REG) {
+      /* Symlinks and unknown types: skip the ones leading to directories */
+      if (fstatat(dirfd(dir), entry->d_name, &st, 0) != 0
+          || S_ISDIR(st.st_mode)) {
+        continue;
+      }
+    }
+    if (name_list_push(&list, entry->d_name, strlen(entry->d_name)) != 0) {
+      break;
+    }
+  }
+  closedir(dir);
+
+  source_set_names(source, list.names, list.count);
+  DPRINT("Completion: %zu executables in %s", list.count, source->dir);
+}
+
+
+/**
+ * Rebuild the list of PATH sources after PATH changed, keeping (and not
+ * rescanning) the directories that are still on it.
+ * @param path New PATH value.
+ */
+static void rebuild_path_sources(const char* path) {
+  NameList dirs = {0};
+  const char* p = path;
+  while (*p) {
+    const char* end = strchrnul(p, ':');
+    if (end > p) {
+      bool seen = false;
+      for (size_t i = 0; i < dirs.count && !seen; i++) {
+        seen = strlen(dirs.names[i]) == (size_t)(end - p)
+               && strncmp(dirs.names[i], p, (size_t)(end - p)) == 0;
+      }
+      if (!seen) {
+        name_list_push(&dirs, p, (size_t)(end - p));
+      }
+    }
+    p = *end ? end + 1 : end;
+  }
+
+  CommandSource* sources = calloc(dirs.count ? dirs.count : 1,
+                                  sizeof(CommandSource));
+  if (sources == NULL) {
+    free_names(dirs.names, dirs.count);
+    return;
+  }
+
+  for (size_t i = 0; i < dirs.count; i++) {
+    for (size_t j = 0; j < g_path_source_count; j++) {
+      if (g_path_sources[j].dir != NULL
+          && strcmp(g_path_sources[j].dir, dirs.names[i]) == 0) {
+        sources[i] = g_path_sources[j];
+        g_path_sources[j].dir = NULL;     /* Moved */
+        g_path_sources[j].names = NULL;
+        g_path_sources[j].count = 0;
+        break;
+      }
+    }
+    if (sources[i].dir == NULL) {
+      sources[i].dir = dirs.names[i];
+      dirs.names[i] = NULL;
+    }
+  }
+
+  for (size_t j = 0; j < g_path_source_count; j++) {
+    source_free(&g_path_sources[j]);
+  }
+  free(g_path_sources);
+  free_names(dirs.names, dirs.count);
+
+  g_path_sources = sources;
+  g_path_source_count = dirs.count;
+}
+
+
+/**
+ * Bring the PATH sources up to date: follow PATH changes, then rescan the
+ * directories whose mtime moved.
+ */
+static void refresh_path(void) {
+  unsigned long generation = jshell_vars_generation();
+  if (!g_index_built || generation != g_vars_generation) {
+    char* path = jshell_var_dup("PATH");
+    if (path == NULL) {
+      path = strdup("");
+    }
+    if (path != NULL
+        && (g_path_value == NULL || strcmp(path, g_path_value) != 0)) {
+      rebuild_path_sources(path);
+      free(g_path_value);
+      g_path_value = path;
+    } else {
+      free(path);
+    }
+    g_vars_generation = generation;
+  }
+
+  for (size_t i = 0; i < g_path_source_count; i++) {
+    CommandSource* source = &g_path_sources[i];
+    struct stat st;
+    bool exists = stat(source->dir, &st) == 0;
+    if (!source->scanned
+        || (exists && (st.st_mtim.tv_sec != source->mtime.tv_sec
+                       || st.st_mtim.tv_nsec != source->mtime.tv_nsec))
+        || (!exists && source->count > 0)) {
+      scan_path_dir(source);
+    }
+  }
+}
+
+
+/**
+ * Collect the names below a trie node, in byte order.
+ * @param node Node to start from.
+ * @param buf Name built so far; has room for depth + max_len bytes.
+ * @param len Length of the name in buf.
+ * @param cap Size of buf.
+ * @param out Candidates to append to.
+ */
+static void trie_collect(uint32_t node, char* buf, size_t len, size_t cap,
+                         JShellCompletions* out) {
+  if (out->item_count >= JSHELL_COMPLETION_MAX_ITEMS) {
+    return;
+  }
+  if (g_nodes[node].ends > 0) {
+    char* item = strndup(buf, len);
+    if (item != NULL) {
+      out->items[out->item_count++] = item;
+    }
+  }
+  if (len + 1 >= cap) {
+    return;
+  }
+  for (uint32_t child = g_nodes[node].first_child; child != 0;
+       child = g_nodes[child].next_sibling) {
+    if (g_nodes[child].words > 0) {
+      buf[len] = (char)g_nodes[child].c;
+      trie_collect(child, buf, len + 1, cap, out);
+    }
+  }
+}
+
+
+/**
+ * Complete a command name from the trie.
+ * @param word Typed prefix.
+ * @param len Length of word.
+ * @param out Candidates to fill.
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int complete_command(const char* word, size_t len,
+                            JShellCompletions* out) {
+  refresh_registry();
+  refresh_path();
+  g_index_built = true;
+
+  if (g_node_count == 0) {
+    return 0;
+  }
+
+  uint32_t node = 0;
+  for (size_t i = 0; i < len; i++) {
+    node = trie_child(node, (unsigned char)word[i], false);
+    if (node == 0) {
+      return 0;
+    }
+  }
+  if (g_nodes[node].words == 0) {
+    return 0;
+  }
+  out->count = g_nodes[node].words;
+
+  /* The shared prefix continues while there is one way to go */
+  size_t common = len;
+  uint32_t walk = node;
+  while (g_nodes[walk].ends == 0) {
+    uint32_t only = 0;
+    int live = 0;
+    for (uint32_t child = g_nodes[walk].first_child; child != 0;
+         child = g_nodes[child].next_sibling) {
+      if (g_nodes[child].words > 0) {
+        only = child;
+        live++;
+      }
+    }
+    if (live != 1) {
+      break;
+    }
+    walk = only;
+    common++;
+  }
+
+  size_t slots = out->count < JSHELL_COMPLETION_MAX_ITEMS
+                 ? out->count : JSHELL_COMPLETION_MAX_ITEMS;
+  out->items = calloc(slots, sizeof(char*));
+  if (out->items == NULL) {
+    return -1;
+  }
+
+  char buf[PATH_MAX];
+  if (len >= sizeof(buf)) {
+    return 0;
+  }
+  memcpy(buf, word, len);
+  trie_collect(node, buf, len, sizeof(buf), out);
+
+  /* ends counts sources, not names: a name on PATH twice is one item */
+  if (out->item_count < slots) {
+    out->count = out->item_count;
+  }
+  out->common = common;
+  return 0;
+}
+
+
+/**
+ * Free one directory cache slot.
+ * @param listing Slot to clear.
+ */
+static void dir_listing_clear(DirListing* listing) {
+  free(listing->path);
+  free_names(listing->names, listing->count);
+  memset(listing, 0, sizeof(*listing));
+}
+
+
+/**
+ * Read a directory into a listing, classifying entries by d_type.
+ * @param listing Empty slot to fill.
+ * @param path Directory path.
+ * @param mtime Directory mtime.
+ * @return 0 on success, -1 on error.
+ */
+static int dir_listing_read(DirListing* listing, const char* path,
+                            struct timespec mtime) {
+  DIR* dir = opendir(path);
+  if (dir == NULL) {
+    return -1;
+  }
+
+  NameList list = {0};
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    const char* name = entry->d_name;
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+      continue;
+    }
+    bool is_dir = entry->d_type == DT_DIR;
+    if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) {
+      struct stat st;
+      is_dir = fstatat(dirfd(dir), name, &st, 0) == 0
+               && S_ISDIR(st.st_mode);
+    }
+    size_t len = strlen(name);
+    char marked[len + 2];
+    memcpy(marked, name, len);
+    marked[len] = '/';
+    if (name_list_push(&list, marked, is_dir ? len + 1 : len) != 0) {
+      break;
+    }
+  }
+  closedir(dir);
+
+  listing->path = strdup(path);
+  if (listing->path == NULL) {
+    free_names(list.names, list.count);
+    return -1;
+  }
+  qsort(list.names, list.count, sizeof(char*), compare_names);
+  listing->names = list.names;
+  listing->count = list.count;
+  listing->mtime = mtime;
+  return 0;
+}
+
+
+/**
+ * Get the listing of a directory, reading it only if it is not cached or
+ * changed since it was read.
+ * @param path Directory path.
+ * @return The listing, or NULL if the directory cannot be read.
+ */
+static DirListing* dir_listing_get(const char* path) {
+  struct stat st;
+  if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+    return NULL;
+  }
+
+  DirListing* slot = &g_dir_cache[0];
+  for (size_t i = 0; i < DIR_CACHE_SLOTS; i++) {
+    DirListing* listing = &g_dir_cache[i];
+    if (listing->path != NULL && strcmp(listing->path, path) == 0) {
+      if (listing->mtime.tv_sec == st.st_mtim.tv_sec
+          && listing->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+        listing->used = ++g_dir_clock;
+        return listing;
+      }
+      slot = listing;
+      break;
+    }
+    if (listing->used < slot->used) {
+      slot = listing;
+    }
+  }
+
+  dir_listing_clear(slot);
+  if (dir_listing_read(slot, path, st.st_mtim) != 0) {
+    return NULL;
+  }
+  slot->used = ++g_dir_clock;
+  return slot;
+}
+
+
+/**
+ * Complete a file name relative to the directory part of the word.
+ * @param word Typed word.
+ * @param len Length of word.
+ * @param out Candidates to fill.
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int complete_file(const char* word, size_t len,
+                         JShellCompletions* out) {
+  const char* slash = NULL;
+  for (size_t i = 0; i < len; i++) {
+    if (word[i] == '/') {
+      slash = word + i;
+    }
+  }
+  size_t dir_len = slash != NULL ? (size_t)(slash - word) + 1 : 0;
+  const char* base = word + dir_len;
+  size_t base_len = len - dir_len;
+
+  char dir_path[PATH_MAX];
+  if (dir_len == 0) {
+    snprintf(dir_path, sizeof(dir_path), ".");
+  } else if (word[0] == '~' && word[1] == '/') {
+    const char* home = jshell_var_get("HOME");
+    if (home == NULL) {
+      return 0;
+    }
+    snprintf(dir_path, sizeof(dir_path), "%s%.*s", home, (int)dir_len - 1,
+             word + 1);
+  } else {
+    snprintf(dir_path, sizeof(dir_path), "%.*s", (int)dir_len, word);
+  }
+
+  DirListing* listing = dir_listing_get(dir_path);
+  if (listing == NULL) {
+    return 0;
+  }
+
+  bool show_hidden = base_len > 0 && base[0] == '.';
+  size_t first = SIZE_MAX;
+  size_t common = 0;
+  for (size_t i = 0; i < listing->count; i++) {
+    const char* name = listing->names[i];
+    if (strncmp(name, base, base_len) != 0
+        || (name[0] == '.' && !show_hidden)) {
+      continue;
+    }
+    if (first == SIZE_MAX) {
+      first = i;
+      common = strlen(name);
+    } else {
+      const char* a = listing->names[first];
+      size_t n = 0;
+      while (n < common && a[n] != '\0' && a[n] == name[n]) {
+        n++;
+      }
+      common = n;
+    }
+    out->count++;
+  }
+  if (out->count == 0) {
+    return 0;
+  }
+
+  size_t slots = out->count < JSHELL_COMPLETION_MAX_ITEMS
+                 ? out->count : JSHELL_COMPLETION_MAX_ITEMS;
+  out->items = calloc(slots, sizeof(char*));
+  if (out->items == NULL) {
+    return -1;
+  }
+  for (size_t i = first; i < listing->count && out->item_count < slots;
+       i++) {
+    const char* name = listing->names[i];
+    if (strncmp(name, base, base_len) != 0
+        || (name[0] == '.' && !show_hidden)) {
+      continue;
+    }
+    char* item;
+    if (asprintf(&item, "%.*s%s", (int)dir_len, word, name) < 0) {
+      return -1;
+    }
+    out->items[out->item_count++] = item;
+  }
+  out->common = dir_len + common;
+  return 0;
+}
+
+
+/**
+ * Check whether a byte ends a word for completion purposes.
+ */
+static bool is_word_break(char c) {
+  return c == ' ' || c == '\t' || strchr("|;&<>()", c) != NULL;
+}
+
+
+/**
+ * Complete the word ending at the cursor.
+ * @param line Line being edited.
+ * @param cursor Cursor position in line.
+ * @param word_start Set to the start of the completed word.
+ * @param out Candidates, to be freed with jshell_completions_free().
+ * @return 0 on success, -1 on error.
+ */
+int jshell_complete(const char* line, size_t cursor, size_t* word_start,
+                    JShellCompletions* out) {
+  memset(out, 0, sizeof(*out));
+
+  size_t start = cursor;
+  while (start > 0 && !is_word_break(line[start - 1])) {
+    start--;
+  }
+  *word_start = start;
+
+  size_t before = start;
+  while (before > 0 && (line[before - 1] == ' ' || line[before - 1] == '\t')) {
+    before--;
+  }
+  bool command_position = before == 0
+                          || strchr("|;&(", line[before - 1]) != NULL;
+
+  const char* word = line + start;
+  size_t len = cursor - start;
+  if (memchr(word, '$', len) != NULL || memchr(word, '"', len) != NULL
+      || memchr(word, '\'', len) != NULL) {
+    return 0;                   /* Expansions and quoting are left alone */
+  }
+
+  if (command_position && memchr(word, '/', len) == NULL) {
+    out->is_command = 1;
+    return complete_command(word, len, out);
+  }
+  return complete_file(word, len, out);
+}
+
+
+/**
+ * Free completion candidates.
+ * @param completions Candidates from jshell_complete().
+ */
+void jshell_completions_free(JShellCompletions* completions) {
+  if (completions == NULL) {
+    return;
+  }
+  free_names(completions->items, completions->item_count);
+  memset(completions, 0, sizeof(*completions));
+}
+
+
+/**
+ * Free the command index and the directory cache.
+ */
+void jshell_completion_cleanup(void) {
+  for (size_t i = 0; i < g_path_source_count; i++) {
+    source_free(&g_path_sources[i]);
+  }
+  free(g_path_sources);
+  g_path_sources = NULL;
+  g_path_source_count = 0;
+
+  free_names(g_registry.names, g_registry.count);
+  memset(&g_registry, 0, sizeof(g_registry));
+
+  free(g_nodes);
+  g_nodes = NULL;
+  g_node_count = 0;
+  g_node_capacity = 0;
+
+  free(g_path_value);
+  g_path_value = NULL;
+  g_index_built = false;
+
+  for (size_t i = 0; i < DIR_CACHE_SLOTS; i++) {
+    dir_listing_clear(&g_dir_cache[i]);
+  }
+}
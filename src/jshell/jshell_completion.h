@@ -0,0 +1,36 @@
+#ifndef JSHELL_COMPLETION_H
+#define JSHELL_COMPLETION_H
+
+#include <stddef.h>
+
+
+// Most candidates collected for one completion; count still reports all
+#define JSHELL_COMPLETION_MAX_ITEMS 1000
+
+
+// Candidates for the word being completed
+typedef struct {
+  char** items;      // Full replacement words, sorted
+  size_t item_count; // Number of entries in items
+  size_t count;      // Number of candidates (may exceed item_count)
+  size_t common;     // Length of the prefix every candidate shares
+  int is_command;    // Whether the word was completed as a command name
+} JShellCompletions;
+
+
+// Complete the word that ends at cursor in line
+// Command positions complete against builtins, linked apps, packages and
+// executables on PATH; other words (and words with a '/') against files
+// *word_start is set to the start of the word the candidates replace
+// Returns 0 on success (possibly with no candidates), -1 on error
+int jshell_complete(const char* line, size_t cursor, size_t* word_start,
+                    JShellCompletions* out);
+
+// Free the candidates filled in by jshell_complete()
+void jshell_completions_free(JShellCompletions* completions);
+
+// Free the command index and the directory cache
+void jshell_completion_cleanup(void);
+
+
+#endif
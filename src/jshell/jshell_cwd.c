@@ -0,0 +1,234 @@
+/**
+ * @file jshell_cwd.c
+ * @brief Working directories held as descriptors, per shell and per thread.
+ *
+ * chdir() changes the directory of every thread in the process, so a cd
+ * while a builtin ran on a worker thread used to move the builtin too,
+ * between two of its open() calls. Here a directory is an O_PATH
+ * descriptor with a reference count. The shell holds one; each worker
+ * thread installs the one it was started in, and relative paths resolve
+ * against that with the *at() calls. The process working directory still
+ * follows the shell's directory, for spawned children and for code that
+ * has not been moved to jshell_cwd_fd() yet.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "jshell_cwd.h"
+#include "utils/jbox_utils.h"
+
+
+struct JShellCwd {
+  atomic_uint refs;
+  int fd;               // O_PATH | O_DIRECTORY
+};
+
+
+/** The shell's directory; swapped by cd on the main thread */
+static JShellCwd* _Atomic g_shell_cwd = NULL;
+
+/** Directory installed by a worker thread, or NULL for the shell's */
+static thread_local JShellCwd* t_cwd = NULL;
+
+
+/**
+ * Wrap a directory descriptor.
+ * @param fd Descriptor, owned by the new directory.
+ * @return Directory with one reference, or NULL (fd is then closed).
+ */
+static JShellCwd* cwd_wrap(int fd) {
+  JShellCwd* cwd = malloc(sizeof(JShellCwd));
+  if (cwd == NULL) {
+    close(fd);
+    errno = ENOMEM;
+    return NULL;
+  }
+  atomic_init(&cwd->refs, 1);
+  cwd->fd = fd;
+  return cwd;
+}
+
+
+/**
+ * Open a path relative to the calling thread's directory as a directory.
+ * @param path Directory to open.
+ * @return New reference, or NULL with errno set.
+ */
+JShellCwd* jshell_cwd_open(const char* path) {
+  int fd = openat(jshell_cwd_fd(), path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    return NULL;
+  }
+  return cwd_wrap(fd);
+}
+
+
+/**
+ * Take another reference to a directory.
+ * @param cwd Directory (may be NULL).
+ * @return cwd.
+ */
+JShellCwd* jshell_cwd_ref(JShellCwd* cwd) {
+  if (cwd != NULL) {
+    atomic_fetch_add_explicit(&cwd->refs, 1, memory_order_relaxed);
+  }
+  return cwd;
+}
+
+
+/**
+ * Drop a reference to a directory, closing it with the last one.
+ * @param cwd Directory (NULL is ignored).
+ */
+void jshell_cwd_unref(JShellCwd* cwd) {
+  if (cwd == NULL
+      || atomic_fetch_sub_explicit(&cwd->refs, 1,
+                                   memory_order_acq_rel) != 1) {
+    return;
+  }
+  close(cwd->fd);
+  free(cwd);
+}
+
+
+/**
+ * Get the shell's directory, opening the process working directory the
+ * first time.
+ * @return The shell's directory (borrowed), or NULL if "." cannot be
+ *         opened.
+ */
+static JShellCwd* shell_cwd(void) {
+  JShellCwd* cwd = atomic_load(&g_shell_cwd);
+  if (cwd != NULL) {
+    return cwd;
+  }
+
+  int fd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+  cwd = fd >= 0 ? cwd_wrap(fd) : NULL;
+  if (cwd == NULL) {
+    return NULL;
+  }
+  JShellCwd* expected = NULL;
+  if (!atomic_compare_exchange_strong(&g_shell_cwd, &expected, cwd)) {
+    jshell_cwd_unref(cwd);
+    return expected;
+  }
+  return cwd;
+}
+
+
+/**
+ * Get the calling thread's directory.
+ * @return The installed directory or the shell's (borrowed).
+ */
+JShellCwd* jshell_cwd_current(void) {
+  return t_cwd != NULL ? t_cwd : shell_cwd();
+}
+
+
+/**
+ * Get the descriptor of the calling thread's directory.
+ * @return Descriptor, or AT_FDCWD if there is no directory.
+ */
+int jshell_cwd_fd(void) {
+  JShellCwd* cwd = jshell_cwd_current();
+  return cwd != NULL ? cwd->fd : AT_FDCWD;
+}
+
+
+/**
+ * Get the path of the calling thread's directory.
+ * @param buf Filled with the path.
+ * @param size Size of buf.
+ * @return buf, or NULL with errno set.
+ */
+char* jshell_cwd_path(char* buf, size_t size) {
+  int fd = jshell_cwd_child_fd();
+  if (fd < 0) {
+    return getcwd(buf, size);
+  }
+
+  char link[64];
+  snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+  ssize_t len = readlink(link, buf, size);
+  if (len < 0) {
+    return NULL;
+  }
+  if ((size_t)len >= size) {
+    errno = ERANGE;
+    return NULL;
+  }
+  buf[len] = '\0';
+  return buf;
+}
+
+
+/**
+ * Install a directory as the calling thread's.
+ * @param cwd Directory (NULL for the shell's); the caller keeps its
+ *            reference while it is installed.
+ * @return The directory installed before.
+ */
+JShellCwd* jshell_cwd_set_thread(JShellCwd* cwd) {
+  JShellCwd* previous = t_cwd;
+  t_cwd = cwd;
+  return previous;
+}
+
+
+/**
+ * Change the shell's directory, as cd does.
+ * @param path Directory, relative to the calling thread's.
+ * @return 0 on success, -1 with errno set.
+ */
+int jshell_cwd_change(const char* path) {
+  JShellCwd* cwd = jshell_cwd_open(path);
+  if (cwd == NULL) {
+    return -1;
+  }
+  if (fchdir(cwd->fd) != 0) {
+    int err = errno;
+    jshell_cwd_unref(cwd);
+    errno = err;
+    return -1;
+  }
+  jshell_cwd_unref(atomic_exchange(&g_shell_cwd, cwd));
+  return 0;
+}
+
+
+/**
+ * Replace the shell's directory, moving the process into the new one.
+ * @param cwd Directory; its reference passes to the shell.
+ * @return The shell's directory before, with the reference it held.
+ */
+JShellCwd* jshell_cwd_swap_shell(JShellCwd* cwd) {
+  JShellCwd* previous = shell_cwd();
+  if (previous != NULL) {
+    jshell_cwd_ref(previous);
+  }
+  if (fchdir(cwd->fd) != 0) {
+    DPRINT("Cannot enter the shell directory: %s", strerror(errno));
+  }
+  jshell_cwd_unref(atomic_exchange(&g_shell_cwd, cwd));
+  return previous;
+}
+
+
+/**
+ * Get the descriptor a child started from the calling thread must enter.
+ * @return The thread's directory if it is not the shell's, otherwise -1.
+ */
+int jshell_cwd_child_fd(void) {
+  if (t_cwd == NULL || t_cwd == atomic_load(&g_shell_cwd)) {
+    return -1;
+  }
+  return t_cwd->fd;
+}
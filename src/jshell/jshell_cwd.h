@@ -0,0 +1,64 @@
+#ifndef JSHELL_CWD_H
+#define JSHELL_CWD_H
+
+#include <stddef.h>
+
+
+// Working directory held open as a descriptor, so a job keeps resolving
+// relative paths against the directory it started in whatever `cd` runs
+// meanwhile
+//
+// The shell has one current directory, which cd changes and the process
+// working directory follows for code that still resolves paths through
+// it. Builtin threads (pipeline stages, background jobs) install the
+// directory they were started in as their own: builtins and linked apps
+// resolve relative paths against jshell_cwd_fd() with openat()/fstatat(),
+// and external commands spawned from such a thread fchdir() into it in
+// the child. Directories are reference counted, so the one a job runs in
+// stays open after the shell has moved on.
+typedef struct JShellCwd JShellCwd;
+
+
+// Open path, relative to the calling thread's directory, as a directory
+// Returns a new reference, or NULL with errno set
+JShellCwd* jshell_cwd_open(const char* path);
+
+// Take another reference to cwd; returns cwd
+JShellCwd* jshell_cwd_ref(JShellCwd* cwd);
+
+// Drop a reference (NULL is ignored); the last one closes the descriptor
+void jshell_cwd_unref(JShellCwd* cwd);
+
+// The calling thread's directory: the one it installed, or the shell's
+// Borrowed; take a reference to keep it past the current command
+// Returns NULL only if the working directory cannot be opened
+JShellCwd* jshell_cwd_current(void);
+
+// Descriptor of the calling thread's directory, for openat() and friends
+// (AT_FDCWD if there is none)
+int jshell_cwd_fd(void);
+
+// Path of the calling thread's directory, as getcwd() reports it
+// Returns buf, or NULL with errno set
+char* jshell_cwd_path(char* buf, size_t size);
+
+// Install cwd as the calling thread's directory (NULL for the shell's)
+// The caller keeps its reference; returns the previous one so calls nest
+JShellCwd* jshell_cwd_set_thread(JShellCwd* cwd);
+
+// Make path, relative to the calling thread's directory, the shell's
+// directory and move the process there (cd)
+// Returns 0, or -1 with errno set (nothing changes then)
+int jshell_cwd_change(const char* path);
+
+// Make cwd the shell's directory and move the process there, taking over
+// the reference; returns the previous directory with its reference, for
+// hosts that switch between several sessions' directories
+JShellCwd* jshell_cwd_swap_shell(JShellCwd* cwd);
+
+// Descriptor a child started from the calling thread must fchdir() to,
+// or -1 if the process working directory is already right
+int jshell_cwd_child_fd(void);
+
+
+#endif
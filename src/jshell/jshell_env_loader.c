@@ -15,6 +15,7 @@
 #include <pwd.h>
 
 #include "jshell_env_loader.h"
+#include "jshell_vars.h"
 #include "utils/jbox_utils.h"
 
 
@@ -232,7 +233,7 @@ void jshell_load_env_file(void) {
       continue;
     }
 
-    if (setenv(name, value, 1) == 0) {
+    if (jshell_var_set(name, value, JSHELL_VAR_EXPORT) == 0) {
       DPRINT("Set %s from env file", name);
       loaded_count++;
     } else {
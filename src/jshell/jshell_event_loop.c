@@ -0,0 +1,123 @@
+/**
+ * @file jshell_event_loop.c
+ * @brief Waiting for input while servicing background job events.
+ *
+ * The prompt blocks here instead of in read(): the wait covers both the
+ * input descriptor and the job control signalfd, so a background job
+ * that exits while the user is idle is reaped and reported right away.
+ * Builtins that wait for time to pass sleep here too, on a timerfd.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <poll.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "jshell_event_loop.h"
+#include "jshell_job_control.h"
+#include "jshell_signals.h"
+#include "utils/jbox_utils.h"
+
+
+/** Longest a sleep goes without looking at its cancel flags, in ms */
+#define EVENT_CANCEL_CHECK_MS 50
+
+
+/**
+ * Wait for input, handling child state changes in the meantime.
+ *
+ * Without a job control descriptor there is nothing to multiplex, so it
+ * returns JSHELL_EVENT_INPUT at once and the caller's read blocks.
+ *
+ * @param input_fd Descriptor to wait on.
+ * @return The event that ended the wait.
+ */
+JShellEvent jshell_event_wait_input(int input_fd) {
+  int job_fd = jshell_job_control_fd();
+  if (job_fd < 0) {
+    return JSHELL_EVENT_INPUT;
+  }
+
+  struct pollfd fds[2] = {
+    { .fd = input_fd, .events = POLLIN },
+    { .fd = job_fd, .events = POLLIN },
+  };
+
+  while (true) {
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR) {
+        return JSHELL_EVENT_INTERRUPTED;
+      }
+      return JSHELL_EVENT_ERROR;
+    }
+
+    if (fds[1].revents & POLLIN) {
+      size_t finished = jshell_reap_background_jobs();
+      if (finished > 0) {
+        DPRINT("%zu background jobs finished at the prompt", finished);
+        return JSHELL_EVENT_JOBS_DONE;
+      }
+    }
+
+    if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+      return JSHELL_EVENT_INPUT;
+    }
+  }
+}
+
+
+/**
+ * Sleep on a timerfd until the time is up or the sleeper is stopped.
+ *
+ * SIGINT may be delivered to another thread than the sleeping one, and
+ * cancel flags are set without a signal, so the wait wakes up every
+ * EVENT_CANCEL_CHECK_MS to look at them; the timerfd alone decides when
+ * the time has passed, without drift from the wakeups.
+ *
+ * @param duration_ns Nanoseconds to sleep.
+ * @return JSHELL_EVENT_TIMER, JSHELL_EVENT_INTERRUPTED or
+ *         JSHELL_EVENT_ERROR.
+ */
+JShellEvent jshell_event_sleep(uint64_t duration_ns) {
+  if (duration_ns == 0) {
+    return JSHELL_EVENT_TIMER;  /* A zero it_value would disarm the timer */
+  }
+
+  int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  if (timer_fd == -1) {
+    return JSHELL_EVENT_ERROR;
+  }
+  struct itimerspec spec = {
+    .it_value = {
+      .tv_sec = (time_t)(duration_ns / 1000000000ULL),
+      .tv_nsec = (long)(duration_ns % 1000000000ULL),
+    },
+  };
+  if (timerfd_settime(timer_fd, 0, &spec, NULL) == -1) {
+    close(timer_fd);
+    return JSHELL_EVENT_ERROR;
+  }
+
+  struct pollfd pfd = { .fd = timer_fd, .events = POLLIN };
+  JShellEvent event;
+  while (true) {
+    if (jshell_is_interrupted()) {
+      event = JSHELL_EVENT_INTERRUPTED;
+      break;
+    }
+    int n = poll(&pfd, 1, EVENT_CANCEL_CHECK_MS);
+    if (n == -1 && errno != EINTR) {
+      event = JSHELL_EVENT_ERROR;
+      break;
+    }
+    if (n > 0 && (pfd.revents & POLLIN)) {
+      event = JSHELL_EVENT_TIMER;
+      break;
+    }
+  }
+
+  close(timer_fd);
+  return event;
+}
@@ -0,0 +1,27 @@
+#ifndef JSHELL_EVENT_LOOP_H
+#define JSHELL_EVENT_LOOP_H
+
+#include <stdint.h>
+
+
+// Why jshell_event_wait_input() or jshell_event_sleep() returned
+typedef enum {
+  JSHELL_EVENT_INPUT,        // The descriptor is readable (or hung up)
+  JSHELL_EVENT_TIMER,        // The time to sleep has passed
+  JSHELL_EVENT_JOBS_DONE,    // Background jobs finished while waiting
+  JSHELL_EVENT_INTERRUPTED,  // A signal interrupted the wait
+  JSHELL_EVENT_ERROR
+} JShellEvent;
+
+
+// Wait until input_fd is readable, reaping background jobs meanwhile
+// Returns as soon as a job finishes so the caller can report it
+JShellEvent jshell_event_wait_input(int input_fd);
+
+// Sleep for duration_ns on a timerfd, in the calling thread
+// Returns early with JSHELL_EVENT_INTERRUPTED on SIGINT, or when the
+// calling stage or job is cancelled (see jshell_is_interrupted())
+JShellEvent jshell_event_sleep(uint64_t duration_ns);
+
+
+#endif
@@ -8,12 +8,22 @@
  *
  * Features:
  * - JSON request building with proper escaping
- * - Response parsing and content extraction
- * - Visual spinner feedback during API calls
+ * - Streaming responses: the streamGenerateContent endpoint sends the
+ *   answer as server-sent events, each a small JSON chunk that is parsed
+ *   and handed on as soon as its blank-line terminator arrives
+ * - Connections kept alive across requests through the jbox_http pool,
+ *   over HTTP/2 where the server offers it
+ * - Large fixed system prompts escaped once, and optionally uploaded
+ *   once as cached content that later requests refer to by name
+ * - Background requests on one thread and curl multi handle, sharing
+ *   an HTTP/2 connection as concurrent streams
+ * - Visual spinner feedback until the first text arrives
  * - Interrupt handling (Ctrl+C support)
  * - Comprehensive error reporting
  */
 
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,11 +31,17 @@
 
 #include "jshell_gemini_api.h"
 #include "jshell_signals.h"
+#include "jshell_stats.h"
+#include "utils/jbox_http.h"
+#include "utils/jbox_json.h"
+#include "utils/jbox_utils.h"
 
 
-/** Base URL for Gemini API endpoints */
-#define GEMINI_API_URL_BASE \
-  "https://generativelanguage.googleapis.com/v1beta/models/"
+/** Root URL of the Gemini API, unless JSHELL_GEMINI_API names another */
+#define GEMINI_API_ROOT "https://generativelanguage.googleapis.com/v1beta/"
+
+/** Longest the background thread sleeps with nothing to do, in ms */
+#define BACKGROUND_IDLE_MS 60000
 
 
 /** Buffer for accumulating HTTP response data */
@@ -36,41 +52,85 @@ typedef struct {
 } ResponseBuffer;
 
 
+/** State of a streamed response while it is being received */
+typedef struct {
+  CURL *curl;
+  ResponseBuffer body;      /**< Unparsed input; all of it on an error */
+  ResponseBuffer event;     /**< Data lines of the event being read */
+  ResponseBuffer content;   /**< Text received so far */
+  char *error;              /**< Error reported inside the stream */
+  GeminiTextFn on_text;
+  void *ctx;
+  int background;           /**< Started by jshell_gemini_submit() */
+  const atomic_bool *cancel; /**< Background only: set to abandon it */
+} StreamState;
+
+
+/** A request in progress: its stream and what it is sent with */
+typedef struct GeminiCall {
+  StreamState st;
+  struct curl_slist *headers;
+  char *api_url;
+  char *request_json;
+  GeminiDoneFn done;          /**< Background only: gets the response */
+  void *done_ctx;
+  struct GeminiCall *next;    /**< In the queue of submitted requests */
+} GeminiCall;
+
+
+/** Guards the background multi handle's creation and queue */
+static pthread_mutex_t bg_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Multi handle of background requests, once the first one starts */
+static CURLM *bg_multi = NULL;
+
+/** Background requests submitted but not yet added to bg_multi */
+static GeminiCall *bg_queue = NULL;
+
+
 /**
- * Callback function for writing HTTP response data.
- *
- * Called by libcurl when response data is received. Accumulates data
- * into a ResponseBuffer, automatically growing the buffer as needed.
+ * Append bytes to a ResponseBuffer, growing it as needed and keeping it
+ * NUL-terminated.
  *
- * @param contents Pointer to received data
- * @param size Size of each data element
- * @param nmemb Number of data elements
- * @param userp User-provided pointer (ResponseBuffer*)
- * @return Number of bytes processed, or 0 on error
+ * @param buf Buffer to append to
+ * @param data Bytes to append
+ * @param len Number of bytes
+ * @return 0 on success, -1 if out of memory
  */
-static size_t write_callback(void *contents, size_t size, size_t nmemb,
-                             void *userp) {
-  size_t realsize = size * nmemb;
-  ResponseBuffer *buf = (ResponseBuffer *)userp;
-
-  if (buf->size + realsize >= buf->capacity) {
-    size_t new_capacity = buf->capacity * 2;
-    if (new_capacity < buf->size + realsize + 1) {
-      new_capacity = buf->size + realsize + 1;
+static int buffer_append(ResponseBuffer *buf, const char *data, size_t len) {
+  if (buf->size + len >= buf->capacity) {
+    size_t new_capacity = buf->capacity ? buf->capacity * 2 : 256;
+    if (new_capacity < buf->size + len + 1) {
+      new_capacity = buf->size + len + 1;
     }
     char *new_data = realloc(buf->data, new_capacity);
     if (!new_data) {
-      return 0;
+      return -1;
     }
     buf->data = new_data;
     buf->capacity = new_capacity;
   }
 
-  memcpy(buf->data + buf->size, contents, realsize);
-  buf->size += realsize;
+  memcpy(buf->data + buf->size, data, len);
+  buf->size += len;
   buf->data[buf->size] = '\0';
+  return 0;
+}
 
-  return realsize;
+
+/**
+ * Callback function for collecting a whole HTTP response.
+ *
+ * @param contents Pointer to received data
+ * @param size Size of each data element
+ * @param nmemb Number of data elements
+ * @param userp User-provided pointer (ResponseBuffer*)
+ * @return Number of bytes processed, or 0 on error
+ */
+static size_t buffer_write_callback(void *contents, size_t size,
+                                    size_t nmemb, void *userp) {
+  size_t realsize = size * nmemb;
+  return buffer_append(userp, contents, realsize) == 0 ? realsize : 0;
 }
 
 
@@ -125,7 +185,9 @@ static void spinner_stop(void) {
  * - Check for user interrupts (Ctrl+C)
  * - Update the spinner animation
  *
- * @param clientp User data (unused)
+ * A background request has neither; it only checks its cancel flag.
+ *
+ * @param clientp Stream state of the request (StreamState*)
  * @param dltotal Total bytes to download (unused)
  * @param dlnow Bytes downloaded so far (unused)
  * @param ultotal Total bytes to upload (unused)
@@ -135,12 +197,16 @@ static void spinner_stop(void) {
 static int progress_callback(void *clientp, curl_off_t dltotal,
                              curl_off_t dlnow, curl_off_t ultotal,
                              curl_off_t ulnow) {
-  (void)clientp;
+  StreamState *st = clientp;
   (void)dltotal;
   (void)dlnow;
   (void)ultotal;
   (void)ulnow;
 
+  if (st->background) {
+    return st->cancel && atomic_load(st->cancel) ? 1 : 0;
+  }
+
   if (jshell_is_interrupted()) {
     spinner_stop();
     return 1;
@@ -157,73 +223,11 @@ static int progress_callback(void *clientp, curl_off_t dltotal,
 }
 
 
-/**
- * Escape a string for use in JSON.
- * Returns a newly allocated string that must be freed.
- */
-static char *json_escape_string(const char *str) {
-  if (str == NULL) {
-    return strdup("");
-  }
-
-  /* Calculate required size */
-  size_t len = 0;
-  for (const char *p = str; *p; p++) {
-    switch (*p) {
-      case '"':
-      case '\\':
-      case '\b':
-      case '\f':
-      case '\n':
-      case '\r':
-      case '\t':
-        len += 2;
-        break;
-      default:
-        if ((unsigned char)*p < 0x20) {
-          len += 6;  /* \uXXXX */
-        } else {
-          len += 1;
-        }
-        break;
-    }
-  }
-
-  char *result = malloc(len + 1);
-  if (!result) {
-    return NULL;
-  }
-
-  char *out = result;
-  for (const char *p = str; *p; p++) {
-    switch (*p) {
-      case '"':  *out++ = '\\'; *out++ = '"'; break;
-      case '\\': *out++ = '\\'; *out++ = '\\'; break;
-      case '\b': *out++ = '\\'; *out++ = 'b'; break;
-      case '\f': *out++ = '\\'; *out++ = 'f'; break;
-      case '\n': *out++ = '\\'; *out++ = 'n'; break;
-      case '\r': *out++ = '\\'; *out++ = 'r'; break;
-      case '\t': *out++ = '\\'; *out++ = 't'; break;
-      default:
-        if ((unsigned char)*p < 0x20) {
-          out += sprintf(out, "\\u%04x", (unsigned char)*p);
-        } else {
-          *out++ = *p;
-        }
-        break;
-    }
-  }
-  *out = '\0';
-
-  return result;
-}
-
-
 /**
  * Build JSON request body for Gemini API.
  *
- * Constructs a properly formatted JSON request with escaped strings for
- * the Gemini API's generateContent endpoint.
+ * Streams the request for the Gemini API's streamGenerateContent endpoint
+ * through the shared JSON writer into a memory buffer.
  *
  * Request format:
  * {
@@ -234,79 +238,167 @@ static char *json_escape_string(const char *str) {
  *   "generationConfig": {"maxOutputTokens": N}
  * }
  *
- * @param system_prompt System prompt to set context (may be NULL or empty)
+ * The systemInstruction is copied in already escaped, or replaced by
+ * "cachedContent": "cachedContents/..." when the context is cached.
+ *
+ * @param context System instruction of the request
  * @param user_message User's message content
  * @param max_tokens Maximum output tokens to generate
  * @return Newly allocated JSON string, or NULL on allocation failure.
  *         Caller must free the returned string.
  */
-static char *build_request_json(const char *system_prompt,
+static char *build_request_json(const GeminiContext *context,
                                 const char *user_message, int max_tokens) {
-  char *escaped_system = json_escape_string(system_prompt);
-  char *escaped_user = json_escape_string(user_message);
-
-  if (!escaped_system || !escaped_user) {
-    free(escaped_system);
-    free(escaped_user);
+  char *json = NULL;
+  size_t json_size = 0;
+  FILE *out = open_memstream(&json, &json_size);
+  if (!out) {
     return NULL;
   }
 
-  /* Calculate buffer size */
-  size_t size = strlen(escaped_system) + strlen(escaped_user) + 512;
-  char *json = malloc(size);
-  if (!json) {
-    free(escaped_system);
-    free(escaped_user);
+  jbox_json_writer_t w;
+  jbox_json_writer_init(&w, out, false);
+  jbox_json_begin_object(&w);
+
+  jbox_json_key(&w, "contents");
+  jbox_json_begin_array(&w);
+  jbox_json_begin_object(&w);
+  jbox_json_key(&w, "role");
+  jbox_json_string(&w, "user");
+  jbox_json_key(&w, "parts");
+  jbox_json_begin_array(&w);
+  jbox_json_begin_object(&w);
+  jbox_json_key(&w, "text");
+  jbox_json_string(&w, user_message);
+  jbox_json_end_object(&w);
+  jbox_json_end_array(&w);
+  jbox_json_end_object(&w);
+  jbox_json_end_array(&w);
+
+  if (context->cached_content) {
+    jbox_json_key(&w, "cachedContent");
+    jbox_json_string(&w, context->cached_content);
+  } else if (context->system_json) {
+    jbox_json_key(&w, "systemInstruction");
+    jbox_json_raw(&w, context->system_json);
+  }
+
+  jbox_json_key(&w, "generationConfig");
+  jbox_json_begin_object(&w);
+  jbox_json_key(&w, "maxOutputTokens");
+  jbox_json_int(&w, max_tokens);
+  jbox_json_end_object(&w);
+
+  jbox_json_end_object(&w);
+
+  if (fclose(out) != 0) {
+    free(json);
     return NULL;
   }
+  return json;
+}
 
-  snprintf(json, size,
-    "{"
-      "\"contents\":["
-        "{\"role\":\"user\",\"parts\":[{\"text\":\"%s\"}]}"
-      "],"
-      "\"systemInstruction\":{\"parts\":[{\"text\":\"%s\"}]},"
-      "\"generationConfig\":{\"maxOutputTokens\":%d}"
-    "}",
-    escaped_user, escaped_system, max_tokens);
 
-  free(escaped_system);
-  free(escaped_user);
+/**
+ * Build the JSON of a systemInstruction.
+ *
+ * Format: {"parts": [{"text": "..."}]}
+ *
+ * @param system_prompt System prompt (may be NULL)
+ * @return Newly allocated JSON string, or NULL on allocation failure.
+ *         Caller must free the returned string.
+ */
+char *jshell_gemini_system_json(const char *system_prompt) {
+  char *json = NULL;
+  size_t json_size = 0;
+  FILE *out = open_memstream(&json, &json_size);
+  if (!out) {
+    return NULL;
+  }
 
+  jbox_json_writer_t w;
+  jbox_json_writer_init(&w, out, false);
+  jbox_json_begin_object(&w);
+  jbox_json_key(&w, "parts");
+  jbox_json_begin_array(&w);
+  jbox_json_begin_object(&w);
+  jbox_json_key(&w, "text");
+  jbox_json_string(&w, system_prompt ? system_prompt : "");
+  jbox_json_end_object(&w);
+  jbox_json_end_array(&w);
+  jbox_json_end_object(&w);
+
+  if (fclose(out) != 0) {
+    free(json);
+    return NULL;
+  }
   return json;
 }
 
 
+/**
+ * Get the root URL requests are sent under.
+ *
+ * JSHELL_GEMINI_API overrides it, e.g. to point the shell at a local
+ * fake of the API in tests. It must end with a slash.
+ *
+ * @return Root URL
+ */
+static const char *api_root(void) {
+  const char *env_root = getenv("JSHELL_GEMINI_API");
+  if (env_root && env_root[0] != '\0') {
+    return env_root;
+  }
+  return GEMINI_API_ROOT;
+}
+
+
 /**
  * Build the full API URL for the Gemini endpoint.
  *
- * Constructs the complete URL by combining the base URL, model name,
- * and the generateContent endpoint.
+ * Constructs the complete URL by combining the root URL, model name,
+ * and the streamGenerateContent endpoint, asking for server-sent events.
  *
  * @param model Model identifier (e.g., "gemini-2.5-flash")
  * @return Newly allocated URL string, or NULL on allocation failure.
  *         Caller must free the returned string.
  */
 static char *build_api_url(const char *model) {
-  /* URL format: BASE + model + ":generateContent" */
-  size_t size = strlen(GEMINI_API_URL_BASE) + strlen(model) + 20;
+  /* URL format: ROOT + "models/" + model + ":streamGenerateContent?alt=sse" */
+  const char *root = api_root();
+  size_t size = strlen(root) + strlen(model) + 40;
   char *url = malloc(size);
   if (!url) {
     return NULL;
   }
 
-  snprintf(url, size, "%s%s:generateContent", GEMINI_API_URL_BASE, model);
+  snprintf(url, size, "%smodels/%s:streamGenerateContent?alt=sse",
+           root, model);
 
   return url;
 }
 
 
 /**
- * Extract content text from a successful Gemini API response.
+ * Move a reader into a member of the current object.
  *
- * Parses the JSON response to extract the generated text from the
- * candidates[0].content.parts[0].text field. Handles JSON unescaping
- * to convert escape sequences back to their original characters.
+ * @param r Reader positioned inside an object
+ * @param key Member name
+ * @param expect Event the member's value must start with
+ * @return 1 if the member exists and starts with expect, 0 otherwise
+ */
+static int enter_member(jbox_json_reader_t *r, const char *key,
+                        jbox_json_event_t expect) {
+  return jbox_json_find_key(r, key) && jbox_json_next(r) == expect;
+}
+
+
+/**
+ * Extract content text from a successful Gemini API response chunk.
+ *
+ * Walks the response with the streaming JSON reader down to
+ * candidates[0].content.parts and returns the text of all its parts,
+ * decoded and joined.
  *
  * Expected response format:
  * {
@@ -320,114 +412,56 @@ static char *build_api_url(const char *model) {
  *   ]
  * }
  *
- * @param json_response Complete JSON response from the API
- * @return Newly allocated string with extracted and unescaped content,
- *         or NULL if parsing fails. Caller must free the returned string.
+ * @param json_response Complete JSON response chunk from the API
+ * @return Newly allocated string with the decoded content (possibly
+ *         empty), or NULL if the chunk has no parts. Caller must free
+ *         the returned string.
  */
 static char *extract_response_content(const char *json_response) {
-  /* Find "candidates" array */
-  const char *candidates_key = "\"candidates\"";
-  const char *candidates_start = strstr(json_response, candidates_key);
-  if (!candidates_start) {
-    return NULL;
-  }
-
-  /* Find "parts" within candidates */
-  const char *parts_key = "\"parts\"";
-  const char *parts_start = strstr(candidates_start, parts_key);
-  if (!parts_start) {
-    return NULL;
-  }
-
-  /* Find "text" key within parts */
-  const char *text_key = "\"text\"";
-  const char *text_start = strstr(parts_start, text_key);
-  if (!text_start) {
-    return NULL;
-  }
-
-  /* Skip to the value */
-  text_start += strlen(text_key);
-  while (*text_start && (*text_start == ':' || *text_start == ' '
-                         || *text_start == '\t' || *text_start == '\n')) {
-    text_start++;
-  }
-
-  if (*text_start != '"') {
-    return NULL;
-  }
-  text_start++;  /* Skip opening quote */
-
-  /* Find end of string, handling escapes */
-  const char *text_end = text_start;
-  while (*text_end && *text_end != '"') {
-    if (*text_end == '\\' && *(text_end + 1)) {
-      text_end += 2;  /* Skip escaped character */
-    } else {
-      text_end++;
+  jbox_json_reader_t r;
+  jbox_json_reader_init(&r, json_response, strlen(json_response));
+
+  ResponseBuffer text = {0};
+  int found = jbox_json_next(&r) == JBOX_JSON_OBJECT_BEGIN
+              && enter_member(&r, "candidates", JBOX_JSON_ARRAY_BEGIN)
+              && jbox_json_next(&r) == JBOX_JSON_OBJECT_BEGIN
+              && enter_member(&r, "content", JBOX_JSON_OBJECT_BEGIN)
+              && enter_member(&r, "parts", JBOX_JSON_ARRAY_BEGIN);
+
+  jbox_json_event_t ev;
+  while (found && (ev = jbox_json_next(&r)) == JBOX_JSON_OBJECT_BEGIN) {
+    /* Take the part's text, skipping its other members */
+    while ((ev = jbox_json_next(&r)) == JBOX_JSON_KEY) {
+      if (strcmp(r.text, "text") == 0) {
+        ev = jbox_json_next(&r);
+        if (ev == JBOX_JSON_STRING
+            && buffer_append(&text, r.text, r.text_len) != 0) {
+          found = 0;
+          break;
+        }
+        jbox_json_skip(&r, ev);
+      } else {
+        jbox_json_skip(&r, jbox_json_next(&r));
+      }
     }
   }
 
-  if (*text_end != '"') {
-    return NULL;
+  jbox_json_reader_free(&r);
+  if (found && !text.data) {
+    return strdup("");
   }
-
-  /* Allocate and unescape the content */
-  size_t escaped_len = text_end - text_start;
-  char *result = malloc(escaped_len + 1);
-  if (!result) {
+  if (!found) {
+    free(text.data);
     return NULL;
   }
-
-  /* Unescape JSON string */
-  char *out = result;
-  const char *in = text_start;
-  while (in < text_end) {
-    if (*in == '\\' && (in + 1) < text_end) {
-      in++;
-      switch (*in) {
-        case '"':  *out++ = '"'; break;
-        case '\\': *out++ = '\\'; break;
-        case 'b':  *out++ = '\b'; break;
-        case 'f':  *out++ = '\f'; break;
-        case 'n':  *out++ = '\n'; break;
-        case 'r':  *out++ = '\r'; break;
-        case 't':  *out++ = '\t'; break;
-        case 'u':
-          /* Handle \uXXXX - just copy basic ASCII range */
-          if ((in + 4) < text_end) {
-            unsigned int codepoint = 0;
-            if (sscanf(in + 1, "%4x", &codepoint) == 1) {
-              if (codepoint < 128) {
-                *out++ = (char)codepoint;
-              } else {
-                /* For non-ASCII, just use placeholder */
-                *out++ = '?';
-              }
-              in += 4;
-            }
-          }
-          break;
-        default:
-          *out++ = *in;
-          break;
-      }
-      in++;
-    } else {
-      *out++ = *in++;
-    }
-  }
-  *out = '\0';
-
-  return result;
+  return text.data;
 }
 
 
 /**
  * Extract error message from a Gemini API error response.
  *
- * Parses the JSON error response to extract the error message from
- * the error.message field. Does not unescape the message string.
+ * Reads the error.message field of the error response.
  *
  * Error response format:
  * {
@@ -443,184 +477,258 @@ static char *extract_response_content(const char *json_response) {
  *         Caller must free the returned string.
  */
 static char *extract_error_message(const char *json_response) {
-  const char *error_key = "\"error\"";
-  const char *error_start = strstr(json_response, error_key);
-  if (!error_start) {
-    return NULL;
+  jbox_json_reader_t r;
+  jbox_json_reader_init(&r, json_response, strlen(json_response));
+
+  char *result = NULL;
+  if (jbox_json_next(&r) == JBOX_JSON_OBJECT_BEGIN
+      && enter_member(&r, "error", JBOX_JSON_OBJECT_BEGIN)
+      && jbox_json_find_key(&r, "message")) {
+    result = jbox_json_read_string(&r);
   }
 
-  const char *message_key = "\"message\"";
-  const char *message_start = strstr(error_start, message_key);
-  if (!message_start) {
-    return NULL;
+  jbox_json_reader_free(&r);
+  return result;
+}
+
+
+/**
+ * Handle one complete server-sent event of a streamed response.
+ *
+ * Each event carries a GenerateContentResponse chunk; its text is added
+ * to the content and passed to the caller's callback, the spinner being
+ * cleared before the first text is shown.
+ *
+ * @param st Stream state holding the event's data
+ * @return 0 to go on, -1 to abort the transfer
+ */
+static int dispatch_event(StreamState *st) {
+  if (st->event.size == 0) {
+    return 0;
   }
 
-  /* Skip to the value */
-  message_start += strlen(message_key);
-  while (*message_start && (*message_start == ':' || *message_start == ' '
-                            || *message_start == '\t'
-                            || *message_start == '\n')) {
-    message_start++;
+  int ret = 0;
+  char *text = extract_response_content(st->event.data);
+  if (text) {
+    size_t len = strlen(text);
+    if (len > 0) {
+      if (!st->background) {
+        spinner_stop();
+      }
+      if (buffer_append(&st->content, text, len) != 0) {
+        ret = -1;
+      } else if (st->on_text) {
+        st->on_text(text, len, st->ctx);
+      }
+    }
+    free(text);
+  } else if (!st->error) {
+    st->error = extract_error_message(st->event.data);
   }
 
-  if (*message_start != '"') {
-    return NULL;
+  st->event.size = 0;
+  st->event.data[0] = '\0';
+  return ret;
+}
+
+
+/**
+ * Callback function for writing HTTP response data.
+ *
+ * A successful response is split into server-sent events as lines
+ * arrive: "data:" lines accumulate into the current event, and a blank
+ * line completes it. Anything else, such as an error response, is kept
+ * whole for parsing once the transfer ends.
+ *
+ * @param contents Pointer to received data
+ * @param size Size of each data element
+ * @param nmemb Number of data elements
+ * @param userp User-provided pointer (StreamState*)
+ * @return Number of bytes processed, or 0 on error
+ */
+static size_t write_callback(void *contents, size_t size, size_t nmemb,
+                             void *userp) {
+  size_t realsize = size * nmemb;
+  StreamState *st = (StreamState *)userp;
+
+  if (buffer_append(&st->body, contents, realsize) != 0) {
+    return 0;
   }
-  message_start++;
 
-  /* Find end of string */
-  const char *message_end = message_start;
-  while (*message_end && *message_end != '"') {
-    if (*message_end == '\\' && *(message_end + 1)) {
-      message_end += 2;
-    } else {
-      message_end++;
-    }
+  long http_code = 0;
+  curl_easy_getinfo(st->curl, CURLINFO_RESPONSE_CODE, &http_code);
+  if (http_code != 200) {
+    return realsize;
   }
 
-  size_t len = message_end - message_start;
-  char *result = malloc(len + 1);
-  if (!result) {
-    return NULL;
+  size_t start = 0;
+  char *nl;
+  while ((nl = memchr(st->body.data + start, '\n',
+                      st->body.size - start)) != NULL) {
+    char *line = st->body.data + start;
+    size_t len = (size_t)(nl - line);
+    if (len > 0 && line[len - 1] == '\r') {
+      len--;
+    }
+    start = (size_t)(nl - st->body.data) + 1;
+
+    if (len == 0) {
+      if (dispatch_event(st) != 0) {
+        return 0;
+      }
+    } else if (len >= 5 && memcmp(line, "data:", 5) == 0) {
+      size_t skip = len > 5 && line[5] == ' ' ? 6 : 5;
+      if ((st->event.size > 0 && buffer_append(&st->event, "\n", 1) != 0)
+          || buffer_append(&st->event, line + skip, len - skip) != 0) {
+        return 0;
+      }
+    }
   }
 
-  memcpy(result, message_start, len);
-  result[len] = '\0';
+  /* Keep only the incomplete last line */
+  memmove(st->body.data, st->body.data + start, st->body.size - start);
+  st->body.size -= start;
+  st->body.data[st->body.size] = '\0';
 
-  return result;
+  return realsize;
 }
 
 
 /**
- * Send a request to the Google Gemini API.
- *
- * Makes an HTTPS POST request to the Gemini API's generateContent endpoint
- * with the specified parameters. Displays a spinner during the request and
- * supports interrupt handling (Ctrl+C).
+ * Prepare a request to the Google Gemini API's streamGenerateContent
+ * endpoint on a handle from the jbox_http pool.
  *
- * The function performs the following steps:
- * 1. Validates input parameters
- * 2. Initializes libcurl
- * 3. Builds the API URL and request JSON
- * 4. Configures HTTP headers with API key
- * 5. Performs the request with spinner feedback
- * 6. Parses the response (success or error)
- * 7. Cleans up all resources
+ * Builds the URL and request JSON, sets the API key header and
+ * configures the handle; the caller performs the transfer, on its own
+ * or on a multi handle, and hands the outcome to call_finish().
  *
+ * @param call Request to fill in; st.on_text, st.ctx and the background
+ *        fields must already be set
  * @param api_key Google API key for authentication (required)
  * @param model Model identifier (e.g., "gemini-2.5-flash") (required)
- * @param system_prompt System prompt to set context (may be NULL or empty)
+ * @param context System instruction of the request (required)
  * @param user_message User's message content (required)
  * @param max_tokens Maximum tokens in response
- * @return GeminiResponse containing either content (on success) or error.
- *         Caller must call jshell_free_gemini_response() to free memory.
+ * @param error Set to a newly allocated error message on failure
+ * @return 0 on success, -1 on error (nothing is left to free)
  */
-GeminiResponse jshell_gemini_request(
-    const char *api_key,
-    const char *model,
-    const char *system_prompt,
-    const char *user_message,
-    int max_tokens) {
-
-  GeminiResponse response = {
-    .content = NULL,
-    .success = 0,
-    .error = NULL
-  };
-
+static int call_begin(GeminiCall *call, const char *api_key,
+                      const char *model, const GeminiContext *context,
+                      const char *user_message, int max_tokens,
+                      char **error) {
   if (!api_key || !model || !user_message) {
-    response.error = strdup("Missing required parameters");
-    return response;
+    *error = strdup("Missing required parameters");
+    return -1;
   }
 
-  CURL *curl = curl_easy_init();
+  CURL *curl = jbox_http_acquire();
   if (!curl) {
-    response.error = strdup("Failed to initialize curl");
-    return response;
+    *error = strdup("Failed to initialize curl");
+    return -1;
   }
 
   /* Build API URL */
-  char *api_url = build_api_url(model);
-  if (!api_url) {
-    response.error = strdup("Failed to build API URL");
-    curl_easy_cleanup(curl);
-    return response;
+  call->api_url = build_api_url(model);
+  if (!call->api_url) {
+    *error = strdup("Failed to build API URL");
+    jbox_http_release(curl);
+    return -1;
   }
 
   /* Build request JSON */
-  char *request_json = build_request_json(system_prompt ? system_prompt : "",
-                                          user_message, max_tokens);
-  if (!request_json) {
-    response.error = strdup("Failed to build request JSON");
-    free(api_url);
-    curl_easy_cleanup(curl);
-    return response;
+  call->request_json = build_request_json(context, user_message, max_tokens);
+  if (!call->request_json) {
+    *error = strdup("Failed to build request JSON");
+    free(call->api_url);
+    jbox_http_release(curl);
+    return -1;
   }
 
-  /* Prepare response buffer */
-  ResponseBuffer resp_buf = {
-    .data = malloc(4096),
-    .size = 0,
-    .capacity = 4096
-  };
-  if (!resp_buf.data) {
-    response.error = strdup("Failed to allocate response buffer");
-    free(request_json);
-    free(api_url);
-    curl_easy_cleanup(curl);
-    return response;
-  }
-  resp_buf.data[0] = '\0';
+  call->st.curl = curl;
 
   /* Set up headers */
-  struct curl_slist *headers = NULL;
-  headers = curl_slist_append(headers, "Content-Type: application/json");
+  call->headers = curl_slist_append(NULL, "Content-Type: application/json");
 
   /* Add API key header */
   char api_key_header[256];
   snprintf(api_key_header, sizeof(api_key_header), "X-goog-api-key: %s",
            api_key);
-  headers = curl_slist_append(headers, api_key_header);
+  call->headers = curl_slist_append(call->headers, api_key_header);
 
   /* Configure curl */
-  curl_easy_setopt(curl, CURLOPT_URL, api_url);
-  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request_json);
+  curl_easy_setopt(curl, CURLOPT_URL, call->api_url);
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, call->headers);
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, call->request_json);
   curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &resp_buf);
-  curl_easy_setopt(curl, CURLOPT_TIMEOUT, 60L);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &call->st);
   curl_easy_setopt(curl, CURLOPT_USERAGENT, "jshell-ai/1.0");
 
-  /* Enable progress callback for spinner and signal interruption */
+  /* HTTP/2 where offered, and keep the connection alive for the next
+   * query; a long answer may stream for a while, so only give up on a
+   * slow connect or a stream that stalls */
+  curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+  curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+  curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 15L);
+  curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+  curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, 60L);
+
+  /* Enable progress callback for spinner and interruption */
   curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
   curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, progress_callback);
-  curl_easy_setopt(curl, CURLOPT_XFERINFODATA, NULL);
+  curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &call->st);
+
+  return 0;
+}
 
-  /* Start spinner and perform request */
-  spinner_start();
-  CURLcode res = curl_easy_perform(curl);
-  spinner_stop();
+
+/**
+ * Turn the outcome of a transfer prepared by call_begin() into a
+ * response, and free everything the request held.
+ *
+ * @param call Request whose transfer has ended
+ * @param res Result of the transfer
+ * @return GeminiResponse containing either content (on success) or error.
+ *         Caller must call jshell_free_gemini_response() to free memory.
+ */
+static GeminiResponse call_finish(GeminiCall *call, CURLcode res) {
+  GeminiResponse response = {
+    .content = NULL,
+    .success = 0,
+    .error = NULL,
+    .http_code = 0
+  };
+  StreamState *st = &call->st;
 
   if (res == CURLE_ABORTED_BY_CALLBACK) {
-    response.error = strdup("Request interrupted");
+    response.error = strdup(st->background ? "Request cancelled"
+                                           : "Request interrupted");
   } else if (res != CURLE_OK) {
     response.error = strdup(curl_easy_strerror(res));
   } else {
     /* Check HTTP response code */
     long http_code = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    curl_easy_getinfo(st->curl, CURLINFO_RESPONSE_CODE, &http_code);
+    response.http_code = http_code;
 
     if (http_code == 200) {
-      /* Extract content from response */
-      response.content = extract_response_content(resp_buf.data);
-      if (response.content) {
+      /* A final event may lack its blank line */
+      if (st->event.size > 0) {
+        dispatch_event(st);
+      }
+      if (st->content.data) {
+        response.content = st->content.data;
+        st->content.data = NULL;
         response.success = 1;
+      } else if (st->error) {
+        response.error = st->error;
+        st->error = NULL;
       } else {
         response.error = strdup("Failed to parse API response");
       }
     } else {
       /* Extract error message */
-      char *api_error = extract_error_message(resp_buf.data);
+      char *api_error = st->body.data ? extract_error_message(st->body.data)
+                                      : NULL;
       if (api_error) {
         response.error = api_error;
       } else {
@@ -632,14 +740,487 @@ GeminiResponse jshell_gemini_request(
     }
   }
 
+  curl_off_t total_us = 0;
+  curl_easy_getinfo(st->curl, CURLINFO_TOTAL_TIME_T, &total_us);
+  jshell_stats_add(JSHELL_STAT_AI_REQUESTS, 1);
+  jshell_stats_add(JSHELL_STAT_AI_LATENCY_US, (uint64_t)total_us);
+  if (!response.success) {
+    jshell_stats_add(JSHELL_STAT_AI_ERRORS, 1);
+  }
+
   /* Cleanup */
+  curl_slist_free_all(call->headers);
+  free(st->body.data);
+  free(st->event.data);
+  free(st->content.data);
+  free(st->error);
+  free(call->request_json);
+  free(call->api_url);
+  jbox_http_release(st->curl);
+
+  return response;
+}
+
+
+/**
+ * Send a request to the Google Gemini API and stream the answer.
+ *
+ * Makes an HTTPS POST request to the Gemini API's streamGenerateContent
+ * endpoint with the specified parameters. Displays a spinner until the
+ * first text arrives and supports interrupt handling (Ctrl+C).
+ *
+ * The handle comes from the jbox_http pool, whose connections and TLS
+ * sessions outlive the request.
+ *
+ * @param api_key Google API key for authentication (required)
+ * @param model Model identifier (e.g., "gemini-2.5-flash") (required)
+ * @param context System instruction of the request (required)
+ * @param user_message User's message content (required)
+ * @param max_tokens Maximum tokens in response
+ * @param on_text Called with each piece of text as it arrives (may be
+ *        NULL)
+ * @param ctx Passed to on_text
+ * @return GeminiResponse containing either content (on success) or error.
+ *         Caller must call jshell_free_gemini_response() to free memory.
+ */
+static GeminiResponse generate(
+    const char *api_key,
+    const char *model,
+    const GeminiContext *context,
+    const char *user_message,
+    int max_tokens,
+    GeminiTextFn on_text,
+    void *ctx) {
+
+  GeminiCall call = {
+    .st = { .on_text = on_text, .ctx = ctx }
+  };
+
+  char *error = NULL;
+  if (call_begin(&call, api_key, model, context, user_message, max_tokens,
+                 &error) != 0) {
+    GeminiResponse response = { .error = error };
+    return response;
+  }
+
+  /* Start spinner and perform request */
+  spinner_start();
+  CURLcode res = curl_easy_perform(call.st.curl);
+  spinner_stop();
+
+  return call_finish(&call, res);
+}
+
+
+/**
+ * Hand a finished background request's response to its caller and free
+ * the request.
+ *
+ * @param call Request whose transfer has ended
+ * @param res Result of the transfer
+ */
+static void background_complete(GeminiCall *call, CURLcode res) {
+  GeminiResponse response = call_finish(call, res);
+  call->done(&response, call->done_ctx);
+  free(call);
+}
+
+
+/**
+ * Body of the thread running background requests.
+ *
+ * Newly submitted requests join the multi handle, transfers advance, and
+ * finished ones are completed; between rounds the thread sleeps in
+ * curl_multi_poll() until there is traffic or jshell_gemini_submit()
+ * wakes it. It lives as long as the shell.
+ *
+ * @param arg Unused
+ * @return Never returns
+ */
+static void *background_main(void *arg) {
+  (void)arg;
+
+  while (1) {
+    pthread_mutex_lock(&bg_lock);
+    GeminiCall *queued = bg_queue;
+    bg_queue = NULL;
+    pthread_mutex_unlock(&bg_lock);
+
+    while (queued) {
+      GeminiCall *call = queued;
+      queued = call->next;
+      if (curl_multi_add_handle(bg_multi, call->st.curl) != CURLM_OK) {
+        background_complete(call, CURLE_FAILED_INIT);
+      }
+    }
+
+    int running = 0;
+    curl_multi_perform(bg_multi, &running);
+
+    CURLMsg *msg;
+    int pending;
+    while ((msg = curl_multi_info_read(bg_multi, &pending)) != NULL) {
+      if (msg->msg != CURLMSG_DONE) {
+        continue;
+      }
+      CURL *curl = msg->easy_handle;
+      CURLcode res = msg->data.result;
+      GeminiCall *call = NULL;
+      curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&call);
+      curl_multi_remove_handle(bg_multi, curl);
+      background_complete(call, res);
+    }
+
+    curl_multi_poll(bg_multi, NULL, 0,
+                    running > 0 ? 1000 : BACKGROUND_IDLE_MS, NULL);
+  }
+
+  return NULL;
+}
+
+
+/**
+ * Create the multi handle and thread for background requests. Called
+ * with bg_lock held.
+ *
+ * The thread blocks every signal, so Ctrl+C and SIGCHLD keep reaching
+ * the shell's main thread.
+ *
+ * @return 0 on success, -1 on error
+ */
+static int background_start(void) {
+  bg_multi = curl_multi_init();
+  if (!bg_multi) {
+    return -1;
+  }
+  /* One connection, with the queries as streams on it */
+  curl_multi_setopt(bg_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+  sigset_t all;
+  sigset_t old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_t thread;
+  int err = pthread_create(&thread, &attr, background_main, NULL);
+  pthread_attr_destroy(&attr);
+
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  if (err != 0) {
+    curl_multi_cleanup(bg_multi);
+    bg_multi = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+
+/**
+ * Send a request to the Google Gemini API and stream the answer.
+ *
+ * The system prompt is escaped into the request on every call; see
+ * jshell_gemini_request_context() for prompts that are sent repeatedly.
+ *
+ * @param api_key Google API key for authentication (required)
+ * @param model Model identifier (e.g., "gemini-2.5-flash") (required)
+ * @param system_prompt System prompt to set context (may be NULL or empty)
+ * @param user_message User's message content (required)
+ * @param max_tokens Maximum tokens in response
+ * @param on_text Called with each piece of text as it arrives (may be
+ *        NULL)
+ * @param ctx Passed to on_text
+ * @return GeminiResponse containing either content (on success) or error.
+ *         Caller must call jshell_free_gemini_response() to free memory.
+ */
+GeminiResponse jshell_gemini_stream(
+    const char *api_key,
+    const char *model,
+    const char *system_prompt,
+    const char *user_message,
+    int max_tokens,
+    GeminiTextFn on_text,
+    void *ctx) {
+  GeminiContext context = {
+    .system_json = jshell_gemini_system_json(system_prompt),
+    .cached_content = NULL
+  };
+  if (!context.system_json) {
+    GeminiResponse response = {
+      .error = strdup("Failed to build request JSON")
+    };
+    return response;
+  }
+
+  GeminiResponse response = generate(api_key, model, &context, user_message,
+                                     max_tokens, on_text, ctx);
+  free((char *)context.system_json);
+  return response;
+}
+
+
+/**
+ * Send a request with a prepared system instruction to the Google Gemini
+ * API.
+ *
+ * The whole answer is returned once it is complete.
+ *
+ * @param api_key Google API key for authentication (required)
+ * @param model Model identifier (e.g., "gemini-2.5-flash") (required)
+ * @param context Prepared system instruction (required)
+ * @param user_message User's message content (required)
+ * @param max_tokens Maximum tokens in response
+ * @return GeminiResponse containing either content (on success) or error.
+ *         Caller must call jshell_free_gemini_response() to free memory.
+ */
+GeminiResponse jshell_gemini_request_context(
+    const char *api_key,
+    const char *model,
+    const GeminiContext *context,
+    const char *user_message,
+    int max_tokens) {
+  return generate(api_key, model, context, user_message, max_tokens,
+                  NULL, NULL);
+}
+
+
+/**
+ * Start a request to the Google Gemini API in the background.
+ *
+ * Background requests run on one shared thread and curl multi handle.
+ * Several in flight at once wait for and share a single HTTP/2
+ * connection as concurrent streams, rather than each opening its own.
+ * They show no spinner and Ctrl+C at the prompt leaves them alone;
+ * setting *cancel abandons one instead.
+ *
+ * @param api_key Google API key for authentication (required)
+ * @param model Model identifier (e.g., "gemini-2.5-flash") (required)
+ * @param system_prompt System prompt to set context (may be NULL or empty)
+ * @param user_message User's message content (required)
+ * @param max_tokens Maximum tokens in response
+ * @param cancel Polled while the request runs; may be NULL. Must stay
+ *        valid until done has been called
+ * @param done Called on the background thread with the response, which
+ *        it must free with jshell_free_gemini_response()
+ * @param ctx Passed to done
+ * @return 0 if the request was started, -1 if not (done is not called)
+ */
+int jshell_gemini_submit(
+    const char *api_key,
+    const char *model,
+    const char *system_prompt,
+    const char *user_message,
+    int max_tokens,
+    const atomic_bool *cancel,
+    GeminiDoneFn done,
+    void *ctx) {
+  GeminiCall *call = calloc(1, sizeof(GeminiCall));
+  GeminiContext context = {
+    .system_json = jshell_gemini_system_json(system_prompt),
+    .cached_content = NULL
+  };
+  if (!call || !context.system_json) {
+    free(call);
+    free((char *)context.system_json);
+    return -1;
+  }
+
+  call->st.background = 1;
+  call->st.cancel = cancel;
+  call->done = done;
+  call->done_ctx = ctx;
+
+  char *error = NULL;
+  int ret = call_begin(call, api_key, model, &context, user_message,
+                       max_tokens, &error);
+  free((char *)context.system_json);
+  if (ret != 0) {
+    DPRINT("Gemini background request not started: %s", error);
+    free(error);
+    free(call);
+    return -1;
+  }
+
+  /* Wait for the shared connection rather than open another */
+  curl_easy_setopt(call->st.curl, CURLOPT_PRIVATE, call);
+  curl_easy_setopt(call->st.curl, CURLOPT_PIPEWAIT, 1L);
+
+  pthread_mutex_lock(&bg_lock);
+  if (!bg_multi && background_start() != 0) {
+    pthread_mutex_unlock(&bg_lock);
+    GeminiResponse response = call_finish(call, CURLE_FAILED_INIT);
+    jshell_free_gemini_response(&response);
+    free(call);
+    return -1;
+  }
+  GeminiCall **tail = &bg_queue;
+  while (*tail) {
+    tail = &(*tail)->next;
+  }
+  *tail = call;
+  pthread_mutex_unlock(&bg_lock);
+
+  curl_multi_wakeup(bg_multi);
+  return 0;
+}
+
+
+/**
+ * Upload a system instruction as cached content.
+ *
+ * Creates a cachedContents entry for the model holding the instruction,
+ * so that requests can name it instead of sending it. The API refuses
+ * instructions below the model's minimum cacheable size.
+ *
+ * Request format:
+ * {
+ *   "model": "models/...",
+ *   "systemInstruction": {"parts": [{"text": "..."}]},
+ *   "ttl": "Ns"
+ * }
+ *
+ * @param api_key Google API key for authentication (required)
+ * @param model Model identifier (e.g., "gemini-2.5-flash") (required)
+ * @param system_json System instruction from jshell_gemini_system_json()
+ * @param ttl_seconds How long the API keeps the entry
+ * @param error Set to a newly allocated error message on failure (may be
+ *        NULL). Caller must free.
+ * @return Newly allocated entry name ("cachedContents/..."), or NULL on
+ *         failure. Caller must free the returned string.
+ */
+char *jshell_gemini_cache_create(const char *api_key, const char *model,
+                                 const char *system_json, int ttl_seconds,
+                                 char **error) {
+  char *name = NULL;
+  char *message = NULL;
+
+  /* Build request JSON */
+  char *request_json = NULL;
+  size_t request_size = 0;
+  FILE *out = open_memstream(&request_json, &request_size);
+  if (out) {
+    char model_name[256];
+    char ttl[32];
+    snprintf(model_name, sizeof(model_name), "models/%s", model);
+    snprintf(ttl, sizeof(ttl), "%ds", ttl_seconds);
+
+    jbox_json_writer_t w;
+    jbox_json_writer_init(&w, out, false);
+    jbox_json_begin_object(&w);
+    jbox_json_key(&w, "model");
+    jbox_json_string(&w, model_name);
+    jbox_json_key(&w, "systemInstruction");
+    jbox_json_raw(&w, system_json);
+    jbox_json_key(&w, "ttl");
+    jbox_json_string(&w, ttl);
+    jbox_json_end_object(&w);
+    if (fclose(out) != 0) {
+      free(request_json);
+      request_json = NULL;
+    }
+  }
+
+  CURL *curl = request_json ? jbox_http_acquire() : NULL;
+  if (!curl) {
+    free(request_json);
+    if (error) {
+      *error = strdup("Failed to prepare cache request");
+    }
+    return NULL;
+  }
+
+  struct curl_slist *headers = NULL;
+  headers = curl_slist_append(headers, "Content-Type: application/json");
+  char api_key_header[256];
+  snprintf(api_key_header, sizeof(api_key_header), "X-goog-api-key: %s",
+           api_key);
+  headers = curl_slist_append(headers, api_key_header);
+
+  char cache_url[1024];
+  snprintf(cache_url, sizeof(cache_url), "%scachedContents", api_root());
+
+  ResponseBuffer resp_buf = {0};
+  curl_easy_setopt(curl, CURLOPT_URL, cache_url);
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request_json);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, buffer_write_callback);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &resp_buf);
+  curl_easy_setopt(curl, CURLOPT_USERAGENT, "jshell-ai/1.0");
+  curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+  curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30L);
+  curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+  curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, progress_callback);
+  curl_easy_setopt(curl, CURLOPT_XFERINFODATA, NULL);
+
+  spinner_start();
+  CURLcode res = curl_easy_perform(curl);
+  spinner_stop();
+  long http_code = 0;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+
+  if (res != CURLE_OK) {
+    message = strdup(curl_easy_strerror(res));
+  } else if (http_code == 200 && resp_buf.data) {
+    /* Response: {"name": "cachedContents/...", "model": ..., ...} */
+    jbox_json_reader_t r;
+    jbox_json_reader_init(&r, resp_buf.data, resp_buf.size);
+    if (jbox_json_next(&r) == JBOX_JSON_OBJECT_BEGIN
+        && jbox_json_find_key(&r, "name")) {
+      name = jbox_json_read_string(&r);
+    }
+    jbox_json_reader_free(&r);
+    if (!name) {
+      message = strdup("Failed to parse API response");
+    }
+  } else {
+    message = resp_buf.data ? extract_error_message(resp_buf.data) : NULL;
+    if (!message) {
+      char error_buf[128];
+      snprintf(error_buf, sizeof(error_buf), "API error (HTTP %ld)",
+               http_code);
+      message = strdup(error_buf);
+    }
+  }
+
+  if (error) {
+    *error = message;
+  } else {
+    free(message);
+  }
   curl_slist_free_all(headers);
   free(resp_buf.data);
   free(request_json);
-  free(api_url);
-  curl_easy_cleanup(curl);
+  jbox_http_release(curl);
+  return name;
+}
 
-  return response;
+
+/**
+ * Send a request to the Google Gemini API.
+ *
+ * Same as jshell_gemini_stream() without a text callback; the whole
+ * answer is returned once it is complete.
+ *
+ * @param api_key Google API key for authentication (required)
+ * @param model Model identifier (e.g., "gemini-2.5-flash") (required)
+ * @param system_prompt System prompt to set context (may be NULL or empty)
+ * @param user_message User's message content (required)
+ * @param max_tokens Maximum tokens in response
+ * @return GeminiResponse containing either content (on success) or error.
+ *         Caller must call jshell_free_gemini_response() to free memory.
+ */
+GeminiResponse jshell_gemini_request(
+    const char *api_key,
+    const char *model,
+    const char *system_prompt,
+    const char *user_message,
+    int max_tokens) {
+  return jshell_gemini_stream(api_key, model, system_prompt, user_message,
+                              max_tokens, NULL, NULL);
 }
 
 
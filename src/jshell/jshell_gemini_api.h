@@ -1,6 +1,9 @@
 #ifndef JSHELL_GEMINI_API_H
 #define JSHELL_GEMINI_API_H
 
+#include <stdatomic.h>
+#include <stddef.h>
+
 /**
  * Google Gemini API client for jshell
  *
@@ -14,8 +17,60 @@ typedef struct {
   char *content;      /* Response content text (caller must free) */
   int success;        /* 1 if successful, 0 if error */
   char *error;        /* Error message if failed (caller must free) */
+  long http_code;     /* HTTP status, or 0 if there was no response */
 } GeminiResponse;
 
+/**
+ * System instruction of a request, prepared ahead of time so a large
+ * fixed prompt is neither escaped nor uploaded again on every request.
+ */
+typedef struct {
+  const char *system_json;    /* From jshell_gemini_system_json(), or NULL */
+  const char *cached_content; /* Name of a cached content holding the
+                                 instruction, used instead if not NULL */
+} GeminiContext;
+
+/**
+ * Called with each piece of a streamed answer as it arrives.
+ * The text is only valid during the call.
+ */
+typedef void (*GeminiTextFn)(const char *text, size_t len, void *ctx);
+
+/**
+ * Called on the background thread when a request started with
+ * jshell_gemini_submit() ends.
+ * Must free the response with jshell_free_gemini_response().
+ */
+typedef void (*GeminiDoneFn)(GeminiResponse *response, void *ctx);
+
+/**
+ * Send a request to the Google Gemini API, streaming the answer.
+ *
+ * The answer arrives as server-sent events over a pooled, kept-alive
+ * connection; on_text sees each piece as soon as it is received, and
+ * the whole answer is also returned in the response.
+ *
+ * @param api_key       Google API key
+ * @param model         Model ID (e.g., "gemini-2.5-flash")
+ * @param system_prompt System prompt to set context
+ * @param user_message  User message content
+ * @param max_tokens    Maximum tokens in response
+ * @param on_text       Called with each piece of text, or NULL
+ * @param ctx           Passed to on_text
+ *
+ * @return GeminiResponse with content or error information.
+ *         Caller must call jshell_free_gemini_response() to free memory.
+ */
+GeminiResponse jshell_gemini_stream(
+  const char *api_key,
+  const char *model,
+  const char *system_prompt,
+  const char *user_message,
+  int max_tokens,
+  GeminiTextFn on_text,
+  void *ctx
+);
+
 /**
  * Send a request to the Google Gemini API.
  *
@@ -36,6 +91,76 @@ GeminiResponse jshell_gemini_request(
   int max_tokens
 );
 
+/**
+ * Escape a system prompt into the JSON of a systemInstruction, once, for
+ * use in a GeminiContext.
+ *
+ * @return Newly allocated JSON (caller must free), or NULL on error.
+ */
+char *jshell_gemini_system_json(const char *system_prompt);
+
+/**
+ * Upload a system instruction as cached content that requests can name
+ * instead of carrying it, for ttl_seconds.
+ *
+ * @param error Set to an error message on failure if not NULL (caller
+ *        must free)
+ * @return Newly allocated name ("cachedContents/..."; caller must free),
+ *         or NULL if the API refused or could not be reached.
+ */
+char *jshell_gemini_cache_create(
+  const char *api_key,
+  const char *model,
+  const char *system_json,
+  int ttl_seconds,
+  char **error
+);
+
+/**
+ * Send a request with a prepared system instruction to the Google Gemini
+ * API.
+ *
+ * @return GeminiResponse with content or error information.
+ *         Caller must call jshell_free_gemini_response() to free memory.
+ */
+GeminiResponse jshell_gemini_request_context(
+  const char *api_key,
+  const char *model,
+  const GeminiContext *context,
+  const char *user_message,
+  int max_tokens
+);
+
+/**
+ * Start a request to the Google Gemini API in the background.
+ *
+ * Requests started this way run concurrently on one background thread,
+ * as streams of a shared HTTP/2 connection. They show no spinner and are
+ * not interrupted by Ctrl+C; setting *cancel abandons one.
+ *
+ * @param api_key       Google API key
+ * @param model         Model ID (e.g., "gemini-2.5-flash")
+ * @param system_prompt System prompt to set context
+ * @param user_message  User message content
+ * @param max_tokens    Maximum tokens in response
+ * @param cancel        Polled while the request runs, or NULL; must stay
+ *                      valid until done is called
+ * @param done          Called on the background thread with the response
+ * @param ctx           Passed to done
+ *
+ * @return 0 if the request was started, -1 if not (done is not called).
+ */
+int jshell_gemini_submit(
+  const char *api_key,
+  const char *model,
+  const char *system_prompt,
+  const char *user_message,
+  int max_tokens,
+  const atomic_bool *cancel,
+  GeminiDoneFn done,
+  void *ctx
+);
+
 /**
  * Free memory allocated in a GeminiResponse.
  */
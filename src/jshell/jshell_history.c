@@ -1,38 +1,831 @@
 /**
  * @file jshell_history.c
- * @brief Command history management for jshell.
+ * @brief Persistent command history for jshell.
  *
- * Implements a circular buffer for storing command history with automatic
- * deduplication of consecutive identical commands.
+ * History lives in two append-only files under ~/.jshell: `history` holds
+ * one record per command (timestamp, exit status, duration and text) and
+ * `history.idx` holds the byte offset of each record. Both are mapped at
+ * startup, so loading costs the same for ten entries or ten million, and
+ * entry i is found with one lookup in the offset index.
+ *
+ * Searches go through a trigram index built in memory the first time a
+ * search runs and extended incrementally afterwards. Each trigram bucket
+ * keeps a delta-encoded list of the entries containing it, so a query
+ * only verifies the entries in its rarest trigram's list.
+ *
+ * Many shells share the files without waiting for each other. A record
+ * goes out in a single write() on an O_APPEND descriptor, then its offset
+ * in another, so concurrent records never interleave; they may be indexed
+ * in a slightly different order than they were written. Records carry a
+ * checksum of their text, and a record torn by a crash is skipped by
+ * scanning for the next valid one. Readers take no lock at all: every
+ * lookup remaps the files if they grew, so other sessions' commands show
+ * up at once. Appending takes a shared flock(), which never waits for
+ * other writers; only loading and compaction take it exclusively.
+ *
+ * Past HISTORY_COMPACT_BYTES a session rewrites the files on a background
+ * thread, keeping the newest occurrence of each command, and renames the
+ * new files over the old ones. Every session notices on its next lookup
+ * (the old data file has no links left) and opens the new ones.
  */
 
+#define _GNU_SOURCE
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "jshell_history.h"
+#include "utils/jbox_utils.h"
+
+
+#define JSHELL_HISTORY_DIR_SUBPATH "/.jshell"
+#define JSHELL_HISTORY_SUBPATH "/.jshell/history"
+#define JSHELL_HISTORY_INDEX_SUBPATH "/.jshell/history.idx"
+#define MAX_PATH_LEN 4096
+
+#define HISTORY_FILE_MAGIC "JSHIST02"
+#define HISTORY_FILE_MAGIC_V1 "JSHIST01"     /* Records without checksums */
+#define HISTORY_FILE_HEADER_SIZE 16
+#define HISTORY_RECORD_MAGIC 0x4A485252u  /* "JHRR" */
+
+/** Data file size past which it is compacted, to half of it */
+#define HISTORY_COMPACT_BYTES (16 * 1024 * 1024)
+
+/** Newest index entries looked at for the record that ends the data */
+#define HISTORY_TAIL_CHECK 64
+
+/** Trigram buckets of the search index (power of two) */
+#define HISTORY_TRIGRAM_BITS 16
+#define HISTORY_TRIGRAM_BUCKETS (1u << HISTORY_TRIGRAM_BITS)
+
+
+/** On-disk record header; the command text and a NUL follow, padded to 8 */
+typedef struct {
+  uint32_t magic;
+  uint32_t length;        /* Text bytes, excluding the NUL */
+  int64_t timestamp;
+  int32_t exit_status;
+  uint32_t checksum;      /* Of the fields above exit_status and the text */
+  uint64_t duration_us;
+} HistoryRecord;
 
 
-/** Circular buffer of command history entries */
-static char *history[JSHELL_HISTORY_MAX];
+/** Delta-encoded list of the entries containing one trigram */
+typedef struct {
+  uint8_t *data;
+  size_t len;
+  size_t cap;
+  size_t count;
+  size_t last;            /* Last entry appended */
+} TrigramPostings;
 
-/** Number of history entries currently stored */
-static size_t history_count = 0;
 
-/** Index of the oldest history entry in the circular buffer */
-static size_t history_start = 0;
+/** State of the open history */
+typedef struct {
+  int data_fd;
+  int append_fd;          /* Same data file, O_APPEND, for new records */
+  int index_fd;           /* O_APPEND */
+  char *data_path;        /* NULL while history is in memory only */
+  char *index_path;
+  const char *data_map;
+  size_t data_len;
+  const uint64_t *index_map;
+  size_t index_len;
+  size_t count;
+
+  bool pending;           /* An added command has not finished yet */
+  off_t pending_offset;
+  uint32_t pending_checksum;
+  dev_t pending_dev;      /* Data file the pending record is in */
+  ino_t pending_ino;
+  struct timespec pending_start;
+
+  TrigramPostings *trigrams;
+  size_t indexed_count;
+} HistoryState;
+
+
+static HistoryState g_history = {
+  .data_fd = -1,
+  .append_fd = -1,
+  .index_fd = -1,
+};
+
+
+static void trigram_index_free(void);
+
+
+/**
+ * Gets the user's home directory.
+ *
+ * Tries the HOME environment variable first, then falls back to
+ * querying the password database.
+ *
+ * @return Pointer to home directory string, or NULL if not found.
+ */
+static const char* get_home_directory(void) {
+  const char* home = getenv("HOME");
+  if (home != NULL && home[0] != '\0') {
+    return home;
+  }
+
+  struct passwd* pw = getpwuid(getuid());
+  if (pw != NULL && pw->pw_dir != NULL) {
+    return pw->pw_dir;
+  }
+
+  return NULL;
+}
+
+
+/**
+ * Rounds a record size up to the record alignment.
+ * @param length Command text length.
+ * @return Bytes the record occupies in the data file.
+ */
+static size_t record_size(size_t length) {
+  size_t size = sizeof(HistoryRecord) + length + 1;
+  return (size + 7) & ~(size_t)7;
+}
+
+
+/**
+ * Computes a record's checksum: FNV-1a over its magic, length and
+ * timestamp and its text. The exit status and duration are patched in
+ * after the record is written and are not covered.
+ * @param record Record header.
+ * @param text Command text, record->length bytes.
+ * @return Checksum.
+ */
+static uint32_t record_checksum(const HistoryRecord *record,
+                                const char *text) {
+  uint32_t hash = 2166136261u;
+  const unsigned char *p = (const unsigned char *)record;
+  for (size_t i = 0; i < offsetof(HistoryRecord, exit_status); i++) {
+    hash = (hash ^ p[i]) * 16777619u;
+  }
+  for (size_t i = 0; i < record->length; i++) {
+    hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+  }
+  return hash;
+}
+
+
+/**
+ * Writes a whole buffer at an offset.
+ * @param fd File descriptor.
+ * @param buf Bytes to write.
+ * @param len Number of bytes.
+ * @param offset File offset.
+ * @return 0 on success, -1 on error.
+ */
+static int pwrite_all(int fd, const void *buf, size_t len, off_t offset) {
+  const char *p = buf;
+  while (len > 0) {
+    ssize_t n = pwrite(fd, p, len, offset);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    p += n;
+    len -= (size_t)n;
+    offset += n;
+  }
+  return 0;
+}
+
+
+/**
+ * Appends a buffer in one write(), so that it lands in one piece however
+ * many processes append to the file. A short write is an error; what it
+ * left is not a valid record and is skipped by readers.
+ * @param fd O_APPEND file descriptor.
+ * @param buf Bytes to write.
+ * @param len Number of bytes.
+ * @return 0 on success, -1 on error.
+ */
+static int append_whole(int fd, const void *buf, size_t len) {
+  ssize_t n;
+  do {
+    n = write(fd, buf, len);
+  } while (n < 0 && errno == EINTR);
+  return n == (ssize_t)len ? 0 : -1;
+}
+
+
+/**
+ * Replaces a mapping with one covering the file's current size.
+ * @param fd File to map.
+ * @param map Mapping pointer (updated).
+ * @param map_len Mapped length (updated).
+ * @param size Current file size.
+ * @return 0 on success, -1 on error (the mapping is then empty).
+ */
+static int remap_file(int fd, const void **map, size_t *map_len,
+                      size_t size) {
+  if (*map != NULL && *map_len == size) {
+    return 0;
+  }
+
+  if (*map != NULL) {
+    munmap((void *)*map, *map_len);
+    *map = NULL;
+    *map_len = 0;
+  }
+
+  if (size == 0) {
+    return 0;
+  }
+
+  void *mapped = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (mapped == MAP_FAILED) {
+    return -1;
+  }
+  *map = mapped;
+  *map_len = size;
+  return 0;
+}
+
+
+/**
+ * Opens the history files, creating them if needed.
+ * @param data_path Path of the record file.
+ * @param index_path Path of the offset index.
+ * @return 0 on success, -1 on error.
+ */
+static int history_open_files(const char *data_path, const char *index_path) {
+  g_history.data_fd = open(data_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  g_history.append_fd = open(data_path,
+                             O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+  g_history.index_fd = open(index_path,
+                            O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+  return (g_history.data_fd < 0 || g_history.append_fd < 0
+          || g_history.index_fd < 0) ? -1 : 0;
+}
+
+
+/**
+ * Opens anonymous in-memory files so history still works for the session.
+ * @return 0 on success, -1 on error.
+ */
+static int history_open_memory(void) {
+  g_history.data_fd = memfd_create("jshell-history", MFD_CLOEXEC);
+  g_history.index_fd = memfd_create("jshell-history-idx", MFD_CLOEXEC);
+  if (g_history.data_fd < 0 || g_history.index_fd < 0
+      || fcntl(g_history.index_fd, F_SETFL, O_APPEND) != 0) {
+    return -1;
+  }
+
+  /* A second open file description, so that only this one appends */
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", g_history.data_fd);
+  g_history.append_fd = open(path, O_WRONLY | O_APPEND | O_CLOEXEC);
+  return g_history.append_fd < 0 ? -1 : 0;
+}
+
+
+/**
+ * Closes the history files and drops the mappings and the search index.
+ */
+static void history_close_files(void) {
+  remap_file(g_history.data_fd, (const void **)&g_history.data_map,
+             &g_history.data_len, 0);
+  remap_file(g_history.index_fd, (const void **)&g_history.index_map,
+             &g_history.index_len, 0);
+  int *fds[] = { &g_history.data_fd, &g_history.append_fd,
+                 &g_history.index_fd };
+  for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+    if (*fds[i] >= 0) {
+      close(*fds[i]);
+    }
+    *fds[i] = -1;
+  }
+  g_history.count = 0;
+  g_history.pending = false;
+  trigram_index_free();
+}
+
+
+/**
+ * Tells whether a compaction has renamed new files over the open ones.
+ * @return true if the open data file has no links left.
+ */
+static bool history_replaced(void) {
+  struct stat st;
+  return g_history.data_path != NULL && g_history.data_fd >= 0
+         && fstat(g_history.data_fd, &st) == 0 && st.st_nlink == 0;
+}
+
+
+/**
+ * Brings the mappings up to date with the files, which other sessions
+ * may have appended to or replaced.
+ * @return 0 on success, -1 on error.
+ */
+static int history_refresh(void) {
+  if (history_replaced()) {
+    DPRINT("History files were compacted, reopening");
+    history_close_files();
+    if (history_open_files(g_history.data_path, g_history.index_path) != 0) {
+      history_close_files();
+    }
+  }
+  if (g_history.data_fd < 0) {
+    return -1;
+  }
+
+  struct stat data_st, index_st;
+  if (fstat(g_history.data_fd, &data_st) != 0
+      || fstat(g_history.index_fd, &index_st) != 0) {
+    return -1;
+  }
+
+  size_t index_size = (size_t)index_st.st_size & ~(size_t)7;
+  if (remap_file(g_history.data_fd, (const void **)&g_history.data_map,
+                 &g_history.data_len, (size_t)data_st.st_size) != 0
+      || remap_file(g_history.index_fd,
+                    (const void **)&g_history.index_map,
+                    &g_history.index_len, index_size) != 0) {
+    g_history.count = 0;
+    return -1;
+  }
+
+  g_history.count = g_history.index_len / sizeof(uint64_t);
+  return 0;
+}
+
+
+/**
+ * Locks the data file, first moving to new files if a compaction has
+ * replaced the open ones.
+ * @param operation LOCK_SH to append, LOCK_EX to load or compact.
+ * @return 0 with the lock held, -1 if history is unavailable.
+ */
+static int history_lock(int operation) {
+  for (;;) {
+    if (history_refresh() != 0) {
+      return -1;
+    }
+    flock(g_history.data_fd, operation);
+    if (!history_replaced()) {
+      return 0;
+    }
+    flock(g_history.data_fd, LOCK_UN);
+  }
+}
+
+
+/**
+ * Locates a record in a mapped data file, checking it is complete.
+ * @param map Mapped data file.
+ * @param map_len Its length.
+ * @param offset Record offset.
+ * @param verify Whether the record must carry a matching checksum.
+ * @return Record header, or NULL if the offset does not hold a record.
+ */
+static const HistoryRecord *record_in(const char *map, size_t map_len,
+                                      uint64_t offset, bool verify) {
+  if (map_len < sizeof(HistoryRecord)
+      || offset < HISTORY_FILE_HEADER_SIZE
+      || offset > map_len - sizeof(HistoryRecord)) {
+    return NULL;
+  }
+
+  const HistoryRecord *record = (const HistoryRecord *)(map + offset);
+  if (record->magic != HISTORY_RECORD_MAGIC
+      || record_size(record->length) > map_len - offset
+      || (verify && record->checksum
+                    != record_checksum(record, (const char *)(record + 1)))) {
+    return NULL;
+  }
+  return record;
+}
+
+
+/**
+ * Locates a record in the data mapping.
+ * @param offset Record offset.
+ * @return Record header, or NULL if the offset does not hold a record.
+ */
+static const HistoryRecord *record_at(uint64_t offset) {
+  return record_in(g_history.data_map, g_history.data_len, offset, true);
+}
+
+
+/**
+ * Finds the first valid record at or after an offset, stepping over what
+ * a torn append left behind. Records after such a tail are no longer
+ * 8-byte aligned, so the scan goes a byte at a time.
+ * @param map Mapped data file.
+ * @param map_len Its length.
+ * @param offset Where to start (updated to the record found).
+ * @param verify Whether records carry checksums.
+ * @return Record header, or NULL at the end of the data.
+ */
+static const HistoryRecord *next_record(const char *map, size_t map_len,
+                                        uint64_t *offset, bool verify) {
+  for (; *offset + sizeof(HistoryRecord) <= map_len; (*offset)++) {
+    const HistoryRecord *record = record_in(map, map_len, *offset, verify);
+    if (record != NULL) {
+      return record;
+    }
+  }
+  return NULL;
+}
+
+
+/**
+ * Indexes the records written after the newest indexed one, which a
+ * session that died between its two appends left out. Concurrent appends
+ * may index records out of order, so the newest is looked for among the
+ * last HISTORY_TAIL_CHECK entries. Called with the lock held exclusively.
+ * @return 0 on success, -1 on error.
+ */
+static int index_repair(void) {
+  uint64_t end = HISTORY_FILE_HEADER_SIZE;
+  size_t first = g_history.count > HISTORY_TAIL_CHECK
+                 ? g_history.count - HISTORY_TAIL_CHECK : 0;
+  for (size_t i = first; i < g_history.count; i++) {
+    const HistoryRecord *record = record_at(g_history.index_map[i]);
+    if (record != NULL
+        && g_history.index_map[i] + record_size(record->length) > end) {
+      end = g_history.index_map[i] + record_size(record->length);
+    }
+  }
+  if (end == g_history.data_len) {
+    return 0;
+  }
+
+  DPRINT("Repairing history index from offset %llu",
+         (unsigned long long)end);
+  uint64_t offset = end;
+  const HistoryRecord *record;
+  while ((record = next_record(g_history.data_map, g_history.data_len,
+                               &offset, true)) != NULL) {
+    if (append_whole(g_history.index_fd, &offset, sizeof(offset)) != 0) {
+      return -1;
+    }
+    offset += record_size(record->length);
+    end = offset;
+  }
+
+  /* Nobody is appending: cut off a torn record at the end */
+  if (end < g_history.data_len
+      && ftruncate(g_history.data_fd, (off_t)end) != 0) {
+    return -1;
+  }
+  return history_refresh();
+}
+
+
+/** Hash of a command's text, for dropping older duplicates */
+static uint64_t text_hash(const char *text, size_t len) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; i++) {
+    hash = (hash ^ (unsigned char)text[i]) * 0x100000001b3ULL;
+  }
+  return hash | 1;        /* 0 marks a free slot */
+}
+
+
+/**
+ * Writes the records to keep into new files and renames them over the
+ * old ones, index first: a session only moves on once the data file is
+ * replaced, and then finds the new index already in place.
+ * @param map Mapped old data file.
+ * @param offsets Offsets of the records to keep, oldest first.
+ * @param count Number of records.
+ * @param data_path Path of the data file.
+ * @param index_path Path of the offset index.
+ * @return 0 on success, -1 on error.
+ */
+static int compact_write(const char *map, const uint64_t *offsets,
+                         size_t count, const char *data_path,
+                         const char *index_path) {
+  char data_tmp[MAX_PATH_LEN];
+  char index_tmp[MAX_PATH_LEN];
+  snprintf(data_tmp, sizeof(data_tmp), "%s.%ld.tmp", data_path,
+           (long)getpid());
+  snprintf(index_tmp, sizeof(index_tmp), "%s.%ld.tmp", index_path,
+           (long)getpid());
+
+  int data_fd = open(data_tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                     0600);
+  int index_fd = open(index_tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                      0600);
+  FILE *data = data_fd >= 0 ? fdopen(data_fd, "w") : NULL;
+  FILE *index = index_fd >= 0 ? fdopen(index_fd, "w") : NULL;
+  if (data == NULL && data_fd >= 0) {
+    close(data_fd);
+  }
+  if (index == NULL && index_fd >= 0) {
+    close(index_fd);
+  }
+  bool ok = data != NULL && index != NULL;
+
+  char header[HISTORY_FILE_HEADER_SIZE] = HISTORY_FILE_MAGIC;
+  uint64_t offset = sizeof(header);
+  ok = ok && fwrite(header, sizeof(header), 1, data) == 1;
+  for (size_t i = 0; ok && i < count; i++) {
+    HistoryRecord record = *(const HistoryRecord *)(map + offsets[i]);
+    const char *text = map + offsets[i] + sizeof(HistoryRecord);
+    size_t size = record_size(record.length);
+    record.checksum = record_checksum(&record, text);
+    ok = fwrite(&record, sizeof(record), 1, data) == 1
+         && fwrite(text, size - sizeof(record), 1, data) == 1
+         && fwrite(&offset, sizeof(offset), 1, index) == 1;
+    offset += size;
+  }
+
+  if (data != NULL && fclose(data) != 0) {
+    ok = false;
+  }
+  if (index != NULL && fclose(index) != 0) {
+    ok = false;
+  }
+  if (ok && rename(index_tmp, index_path) == 0
+      && rename(data_tmp, data_path) == 0) {
+    return 0;
+  }
+  unlink(data_tmp);
+  unlink(index_tmp);
+  return -1;
+}
+
+
+/**
+ * Rewrites the history files in the current format, dropping torn
+ * records. Called with the data file locked exclusively.
+ * @param fd Locked data file.
+ * @param data_path Path of the data file.
+ * @param index_path Path of the offset index.
+ * @param trim Keep only the newest occurrence of each command, up to half
+ *             of HISTORY_COMPACT_BYTES; otherwise keep every record.
+ * @return 0 on success, -1 on error.
+ */
+static int history_compact_locked(int fd, const char *data_path,
+                                  const char *index_path, bool trim) {
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < HISTORY_FILE_HEADER_SIZE) {
+    return -1;
+  }
+  size_t map_len = (size_t)st.st_size;
+  const char *map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    return -1;
+  }
+  bool verify = memcmp(map, HISTORY_FILE_MAGIC,
+                       strlen(HISTORY_FILE_MAGIC)) == 0;
+
+  /* Every valid record, oldest first */
+  uint64_t *offsets = NULL;
+  size_t count = 0;
+  size_t cap = 0;
+  int result = -1;
+  uint64_t offset = HISTORY_FILE_HEADER_SIZE;
+  const HistoryRecord *record;
+  while ((record = next_record(map, map_len, &offset, verify)) != NULL) {
+    if (count == cap) {
+      cap = cap > 0 ? cap * 2 : 1024;
+      uint64_t *grown = realloc(offsets, cap * sizeof(uint64_t));
+      if (grown == NULL) {
+        goto out;
+      }
+      offsets = grown;
+    }
+    offsets[count++] = offset;
+    offset += record_size(record->length);
+  }
+
+  /* Newest first: keep commands not seen yet while they fit */
+  size_t kept = count;
+  size_t slots = 1024;
+  while (slots < count * 2) {
+    slots *= 2;
+  }
+  uint64_t *seen = trim ? calloc(slots, sizeof(uint64_t)) : NULL;
+  if (trim && seen == NULL) {
+    goto out;
+  }
+  size_t bytes = HISTORY_FILE_HEADER_SIZE;
+  for (size_t i = count; trim && i > 0; i--) {
+    const HistoryRecord *r = (const HistoryRecord *)(map + offsets[i - 1]);
+    if (bytes + record_size(r->length) > HISTORY_COMPACT_BYTES / 2) {
+      break;
+    }
+    uint64_t hash = text_hash((const char *)(r + 1), r->length);
+    size_t slot = hash & (slots - 1);
+    while (seen[slot] != 0 && seen[slot] != hash) {
+      slot = (slot + 1) & (slots - 1);
+    }
+    if (seen[slot] == hash) {
+      continue;
+    }
+    seen[slot] = hash;
+    bytes += record_size(r->length);
+    offsets[--kept] = offsets[i - 1];
+  }
+  free(seen);
+  if (!trim) {
+    kept = 0;
+  }
+
+  DPRINT("Compacting history: %zu of %zu records kept", count - kept,
+         count);
+  result = compact_write(map, offsets + kept, count - kept, data_path,
+                         index_path);
+
+out:
+  free(offsets);
+  munmap((void *)map, map_len);
+  return result;
+}
+
+
+/** Paths a background compaction works on */
+typedef struct {
+  char *data_path;
+  char *index_path;
+} HistoryCompactJob;
+
+
+/**
+ * Background thread compacting the history files, unless another session
+ * has already done it.
+ * @param arg The HistoryCompactJob, freed here.
+ * @return NULL.
+ */
+static void *history_compact_thread(void *arg) {
+  HistoryCompactJob *job = arg;
+  int fd = open(job->data_path, O_RDONLY | O_CLOEXEC);
+  if (fd >= 0) {
+    flock(fd, LOCK_EX);
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_nlink > 0
+        && st.st_size > HISTORY_COMPACT_BYTES) {
+      history_compact_locked(fd, job->data_path, job->index_path, true);
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+  }
+  free(job->data_path);
+  free(job->index_path);
+  free(job);
+  return NULL;
+}
+
+
+/**
+ * Starts compacting the history files in the background.
+ */
+static void history_start_compaction(void) {
+  HistoryCompactJob *job = calloc(1, sizeof(HistoryCompactJob));
+  if (job == NULL) {
+    return;
+  }
+  job->data_path = strdup(g_history.data_path);
+  job->index_path = strdup(g_history.index_path);
+
+  pthread_t thread;
+  if (job->data_path == NULL || job->index_path == NULL
+      || pthread_create(&thread, NULL, history_compact_thread, job) != 0) {
+    free(job->data_path);
+    free(job->index_path);
+    free(job);
+    return;
+  }
+  pthread_detach(thread);
+}
+
+
+/**
+ * Writes the file header to an empty data file, or validates an existing
+ * one, and makes sure the offset index covers it. Called with the lock
+ * held exclusively; an old-format file is converted, after which the lock
+ * is held on the new one.
+ * @return 0 on success, -1 if the files are unusable.
+ */
+static int history_load(void) {
+  if (history_refresh() != 0) {
+    return -1;
+  }
+
+  if (g_history.data_len == 0) {
+    char header[HISTORY_FILE_HEADER_SIZE] = HISTORY_FILE_MAGIC;
+    if (pwrite_all(g_history.data_fd, header, sizeof(header), 0) != 0
+        || ftruncate(g_history.index_fd, 0) != 0
+        || history_refresh() != 0) {
+      return -1;
+    }
+  }
+
+  if (g_history.data_len >= HISTORY_FILE_HEADER_SIZE
+      && g_history.data_path != NULL
+      && memcmp(g_history.data_map, HISTORY_FILE_MAGIC_V1,
+                strlen(HISTORY_FILE_MAGIC_V1)) == 0) {
+    DPRINT("Converting history to records with checksums");
+    if (history_compact_locked(g_history.data_fd, g_history.data_path,
+                               g_history.index_path, false) != 0) {
+      return -1;
+    }
+    if (history_lock(LOCK_EX) != 0) {
+      return -1;
+    }
+    return history_load();
+  }
+
+  if (g_history.data_len < HISTORY_FILE_HEADER_SIZE
+      || memcmp(g_history.data_map, HISTORY_FILE_MAGIC,
+                strlen(HISTORY_FILE_MAGIC)) != 0) {
+    fprintf(stderr, "jshell: warning: unrecognized history file format\n");
+    return -1;
+  }
+
+  return index_repair();
+}
 
 
 /**
  * Initializes the history system.
  *
- * Clears all history entries and resets the circular buffer state.
- * This should be called once during shell initialization.
+ * Opens and maps ~/.jshell/history and its offset index, converting or
+ * compacting them as needed. If they cannot be used, history is kept in
+ * memory for this session only. This should be called once during shell
+ * initialization.
  */
 void jshell_history_init(void) {
-  history_count = 0;
-  history_start = 0;
-  for (size_t i = 0; i < JSHELL_HISTORY_MAX; i++) {
-    history[i] = NULL;
+  const char *home = get_home_directory();
+  bool opened = false;
+
+  if (home != NULL) {
+    char dir_path[MAX_PATH_LEN];
+    char data_path[MAX_PATH_LEN];
+    char index_path[MAX_PATH_LEN];
+    snprintf(dir_path, sizeof(dir_path), "%s%s", home,
+             JSHELL_HISTORY_DIR_SUBPATH);
+    snprintf(data_path, sizeof(data_path), "%s%s", home,
+             JSHELL_HISTORY_SUBPATH);
+    snprintf(index_path, sizeof(index_path), "%s%s", home,
+             JSHELL_HISTORY_INDEX_SUBPATH);
+
+    mkdir(dir_path, 0755);
+    g_history.data_path = strdup(data_path);
+    g_history.index_path = strdup(index_path);
+    if (g_history.data_path != NULL && g_history.index_path != NULL
+        && history_open_files(data_path, index_path) == 0
+        && history_lock(LOCK_EX) == 0) {
+      int result = history_load();
+      flock(g_history.data_fd, LOCK_UN);
+      if (result == 0) {
+        opened = true;
+      }
+    }
+    if (!opened) {
+      history_close_files();
+      free(g_history.data_path);
+      free(g_history.index_path);
+      g_history.data_path = NULL;
+      g_history.index_path = NULL;
+    }
+  }
+
+  if (!opened) {
+    fprintf(stderr, "jshell: warning: history will not be saved\n");
+    if (history_open_memory() != 0 || history_load() != 0) {
+      history_close_files();
+      return;
+    }
+  }
+
+  if (g_history.data_path != NULL
+      && g_history.data_len > HISTORY_COMPACT_BYTES) {
+    history_start_compaction();
+  }
+
+  DPRINT("History loaded: %zu entries", g_history.count);
+}
+
+
+/**
+ * Gets the current monotonic time.
+ * @param ts Filled with the time.
+ */
+static void monotonic_now(struct timespec *ts) {
+  if (clock_gettime(CLOCK_MONOTONIC, ts) != 0) {
+    ts->tv_sec = 0;
+    ts->tv_nsec = 0;
   }
 }
 
@@ -41,42 +834,171 @@ void jshell_history_init(void) {
  * Adds a command to the history.
  *
  * If the line is identical to the most recent history entry, it is not added
- * (consecutive duplicate prevention). When the history is full, the oldest
- * entry is removed to make room for the new one.
+ * (consecutive duplicate prevention) and the most recent entry receives the
+ * new status instead. Otherwise the record is appended immediately with an
+ * unknown exit status; jshell_history_finish() fills it in.
  *
- * @param line Command line to add to history (will be duplicated internally).
+ * @param line Command line to add to history (copied to the history file).
  */
 void jshell_history_add(const char *line) {
-  if (line == NULL || line[0] == '\0') {
+  g_history.pending = false;
+
+  struct stat st;
+  if (line == NULL || line[0] == '\0' || history_lock(LOCK_SH) != 0) {
     return;
   }
+  if (fstat(g_history.data_fd, &st) != 0) {
+    flock(g_history.data_fd, LOCK_UN);
+    return;
+  }
+  g_history.pending_dev = st.st_dev;
+  g_history.pending_ino = st.st_ino;
 
-  if (history_count > 0) {
-    size_t last_idx = (history_start + history_count - 1) % JSHELL_HISTORY_MAX;
-    if (history[last_idx] != NULL && strcmp(history[last_idx], line) == 0) {
-      return;
+  const char *last = (g_history.count > 0)
+                     ? jshell_history_get(g_history.count - 1) : NULL;
+  if (last != NULL && strcmp(last, line) == 0) {
+    /* The repeat updates the existing entry's status and duration */
+    g_history.pending = true;
+    g_history.pending_offset =
+      (off_t)g_history.index_map[g_history.count - 1];
+    g_history.pending_checksum =
+      record_at(g_history.index_map[g_history.count - 1])->checksum;
+    monotonic_now(&g_history.pending_start);
+    flock(g_history.data_fd, LOCK_UN);
+    return;
+  }
+
+  size_t length = strlen(line);
+  size_t size = record_size(length);
+  char *buf = calloc(1, size);
+  if (buf == NULL) {
+    flock(g_history.data_fd, LOCK_UN);
+    return;
+  }
+
+  HistoryRecord *record = (HistoryRecord *)buf;
+  record->magic = HISTORY_RECORD_MAGIC;
+  record->length = (uint32_t)length;
+  record->timestamp = (int64_t)time(NULL);
+  record->exit_status = JSHELL_HISTORY_STATUS_UNKNOWN;
+  memcpy(buf + sizeof(HistoryRecord), line, length);
+  record->checksum = record_checksum(record, line);
+
+  /* Data first, so an index entry never points past the data; the
+   * descriptor's position is where this append ended */
+  off_t end;
+  if (append_whole(g_history.append_fd, buf, size) == 0
+      && (end = lseek(g_history.append_fd, 0, SEEK_CUR)) >= (off_t)size) {
+    uint64_t index_entry = (uint64_t)end - size;
+    if (append_whole(g_history.index_fd, &index_entry,
+                     sizeof(index_entry)) == 0) {
+      g_history.pending = true;
+      g_history.pending_offset = (off_t)index_entry;
+      g_history.pending_checksum = record->checksum;
+      monotonic_now(&g_history.pending_start);
     }
   }
 
-  if (history_count < JSHELL_HISTORY_MAX) {
-    size_t idx = (history_start + history_count) % JSHELL_HISTORY_MAX;
-    history[idx] = strdup(line);
-    history_count++;
-  } else {
-    free(history[history_start]);
-    history[history_start] = strdup(line);
-    history_start = (history_start + 1) % JSHELL_HISTORY_MAX;
+  free(buf);
+  history_refresh();
+  flock(g_history.data_fd, LOCK_UN);
+}
+
+
+/**
+ * Records how the most recently added command ended.
+ *
+ * Patches the exit status and duration into the record written by
+ * jshell_history_add(). Does nothing if that call did not add a record,
+ * or if a compaction has since replaced the data file or moved the
+ * record; the shared lock keeps one from starting during the write.
+ *
+ * @param exit_status Exit status of the command.
+ */
+void jshell_history_finish(int exit_status) {
+  if (!g_history.pending || g_history.data_fd < 0) {
+    return;
+  }
+  g_history.pending = false;
+
+  struct timespec now;
+  monotonic_now(&now);
+  int64_t elapsed_ns =
+    (int64_t)(now.tv_sec - g_history.pending_start.tv_sec) * 1000000000LL
+    + (now.tv_nsec - g_history.pending_start.tv_nsec);
+
+  HistoryRecord update = {
+    .exit_status = exit_status,
+    .checksum = g_history.pending_checksum,
+    .duration_us = (elapsed_ns > 0) ? (uint64_t)elapsed_ns / 1000 : 0,
+  };
+
+  if (history_lock(LOCK_SH) != 0) {
+    return;
   }
+
+  struct stat st;
+  HistoryRecord current;
+  if (fstat(g_history.data_fd, &st) != 0
+      || st.st_dev != g_history.pending_dev
+      || st.st_ino != g_history.pending_ino
+      || pread(g_history.data_fd, &current, sizeof(current),
+               g_history.pending_offset) != (ssize_t)sizeof(current)
+      || current.magic != HISTORY_RECORD_MAGIC
+      || current.checksum != g_history.pending_checksum) {
+    DPRINT("History record moved; status not recorded");
+    flock(g_history.data_fd, LOCK_UN);
+    return;
+  }
+
+  off_t field = g_history.pending_offset
+                + (off_t)offsetof(HistoryRecord, exit_status);
+  size_t field_len = sizeof(HistoryRecord)
+                     - offsetof(HistoryRecord, exit_status);
+  if (pwrite_all(g_history.data_fd, &update.exit_status, field_len,
+                 field) != 0) {
+    DPRINT("Failed to record history status: %s", strerror(errno));
+  }
+  flock(g_history.data_fd, LOCK_UN);
 }
 
 
 /**
  * Gets the number of commands currently in history.
  *
- * @return Number of history entries (0 to JSHELL_HISTORY_MAX).
+ * Picks up entries appended by other sessions since the last call.
+ *
+ * @return Number of history entries.
  */
 size_t jshell_history_count(void) {
-  return history_count;
+  history_refresh();
+  return g_history.count;
+}
+
+
+/**
+ * Retrieves a history entry with its metadata.
+ *
+ * @param index Index of the entry (0 is the oldest).
+ * @param entry Filled with the entry; the line stays valid until the
+ *              history is next added to or refreshed.
+ * @return 0 on success, -1 if index is out of range or the record is bad.
+ */
+int jshell_history_get_entry(size_t index, JShellHistoryEntry *entry) {
+  if (index >= g_history.count) {
+    return -1;
+  }
+
+  const HistoryRecord *record = record_at(g_history.index_map[index]);
+  if (record == NULL) {
+    return -1;
+  }
+
+  entry->line = (const char *)(record + 1);
+  entry->timestamp = (time_t)record->timestamp;
+  entry->exit_status = record->exit_status;
+  entry->duration_us = record->duration_us;
+  return 0;
 }
 
 
@@ -91,9 +1013,187 @@ size_t jshell_history_count(void) {
  *         not be modified or freed by the caller.
  */
 const char *jshell_history_get(size_t index) {
-  if (index >= history_count) {
+  JShellHistoryEntry entry;
+  if (jshell_history_get_entry(index, &entry) != 0) {
     return NULL;
   }
-  size_t actual_idx = (history_start + index) % JSHELL_HISTORY_MAX;
-  return history[actual_idx];
+  return entry.line;
+}
+
+
+/**
+ * Maps a trigram to its bucket.
+ * @param s At least three bytes.
+ * @return Bucket index.
+ */
+static size_t trigram_bucket(const char *s) {
+  uint32_t key = ((uint32_t)(unsigned char)s[0] << 16)
+                 | ((uint32_t)(unsigned char)s[1] << 8)
+                 | (uint32_t)(unsigned char)s[2];
+  return (size_t)((key * 2654435761u) >> (32 - HISTORY_TRIGRAM_BITS));
+}
+
+
+/**
+ * Appends an entry to a posting list as a varint delta.
+ * @param postings Posting list.
+ * @param index Entry index (not smaller than the last one appended).
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int postings_append(TrigramPostings *postings, size_t index) {
+  if (postings->count > 0 && postings->last == index) {
+    return 0;
+  }
+
+  if (postings->len + 10 > postings->cap) {
+    size_t new_cap = (postings->cap == 0) ? 16 : postings->cap * 2;
+    uint8_t *grown = realloc(postings->data, new_cap);
+    if (grown == NULL) {
+      return -1;
+    }
+    postings->data = grown;
+    postings->cap = new_cap;
+  }
+
+  size_t delta = index - ((postings->count > 0) ? postings->last : 0);
+  do {
+    uint8_t byte = delta & 0x7f;
+    delta >>= 7;
+    postings->data[postings->len++] = byte | (delta ? 0x80 : 0);
+  } while (delta != 0);
+
+  postings->last = index;
+  postings->count++;
+  return 0;
+}
+
+
+/**
+ * Adds any entries not yet in the trigram index.
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int trigram_index_update(void) {
+  if (g_history.trigrams == NULL) {
+    g_history.trigrams = calloc(HISTORY_TRIGRAM_BUCKETS,
+                                sizeof(TrigramPostings));
+    if (g_history.trigrams == NULL) {
+      return -1;
+    }
+    g_history.indexed_count = 0;
+  }
+
+  for (; g_history.indexed_count < g_history.count;
+       g_history.indexed_count++) {
+    JShellHistoryEntry entry;
+    if (jshell_history_get_entry(g_history.indexed_count, &entry) != 0) {
+      continue;
+    }
+    size_t len = strlen(entry.line);
+    for (size_t i = 0; i + 3 <= len; i++) {
+      TrigramPostings *postings =
+        &g_history.trigrams[trigram_bucket(entry.line + i)];
+      if (postings_append(postings, g_history.indexed_count) != 0) {
+        return -1;
+      }
+    }
+  }
+
+  DPRINT("History trigram index covers %zu entries",
+         g_history.indexed_count);
+  return 0;
+}
+
+
+/**
+ * Drops the trigram index, for history files that were replaced.
+ */
+static void trigram_index_free(void) {
+  if (g_history.trigrams == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < HISTORY_TRIGRAM_BUCKETS; i++) {
+    free(g_history.trigrams[i].data);
+  }
+  free(g_history.trigrams);
+  g_history.trigrams = NULL;
+  g_history.indexed_count = 0;
+}
+
+
+/**
+ * Checks one entry against a query and reports it if it matches.
+ * @return 1 if the entry matched, 0 otherwise.
+ */
+static size_t search_check(size_t index, const char *query, size_t query_len,
+                           JShellHistoryMatch mode,
+                           JShellHistoryVisitor visit, void *userdata) {
+  JShellHistoryEntry entry;
+  if (jshell_history_get_entry(index, &entry) != 0) {
+    return 0;
+  }
+
+  bool match = (mode == HISTORY_MATCH_PREFIX)
+               ? strncmp(entry.line, query, query_len) == 0
+               : strstr(entry.line, query) != NULL;
+  if (match && visit != NULL) {
+    visit(index, &entry, userdata);
+  }
+  return match ? 1 : 0;
+}
+
+
+/**
+ * Searches the history.
+ *
+ * Queries of three or more bytes only look at the entries listed under the
+ * query's rarest trigram; shorter queries scan every entry.
+ *
+ * @param query Text to look for.
+ * @param mode Substring or prefix match.
+ * @param visit Called for each match, oldest first (may be NULL).
+ * @param userdata Passed to visit.
+ * @return Number of matching entries.
+ */
+size_t jshell_history_search(const char *query, JShellHistoryMatch mode,
+                             JShellHistoryVisitor visit, void *userdata) {
+  if (query == NULL || history_refresh() != 0) {
+    return 0;
+  }
+
+  size_t query_len = strlen(query);
+  size_t matches = 0;
+
+  if (query_len < 3 || trigram_index_update() != 0) {
+    for (size_t i = 0; i < g_history.count; i++) {
+      matches += search_check(i, query, query_len, mode, visit, userdata);
+    }
+    return matches;
+  }
+
+  const TrigramPostings *rarest = NULL;
+  for (size_t i = 0; i + 3 <= query_len; i++) {
+    const TrigramPostings *postings =
+      &g_history.trigrams[trigram_bucket(query + i)];
+    if (rarest == NULL || postings->count < rarest->count) {
+      rarest = postings;
+    }
+  }
+
+  size_t index = 0;
+  size_t pos = 0;
+  for (size_t n = 0; n < rarest->count; n++) {
+    size_t delta = 0;
+    unsigned shift = 0;
+    uint8_t byte;
+    do {
+      byte = rarest->data[pos++];
+      delta |= (size_t)(byte & 0x7f) << shift;
+      shift += 7;
+    } while (byte & 0x80);
+    index += delta;
+
+    matches += search_check(index, query, query_len, mode, visit, userdata);
+  }
+
+  return matches;
 }
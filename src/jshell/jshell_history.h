@@ -2,12 +2,56 @@
 #define JSHELL_HISTORY_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <time.h>
 
-#define JSHELL_HISTORY_MAX 1000
+// Exit status recorded while a command runs (or if the shell died)
+#define JSHELL_HISTORY_STATUS_UNKNOWN (-1)
 
+
+// One history entry; line points into the history mapping and stays valid
+// until the next call that adds to or refreshes the history
+typedef struct {
+  const char *line;
+  time_t timestamp;        // When the command started
+  int exit_status;         // JSHELL_HISTORY_STATUS_UNKNOWN if not finished
+  uint64_t duration_us;    // Wall-clock run time
+} JShellHistoryEntry;
+
+
+// How jshell_history_search() matches the query
+typedef enum {
+  HISTORY_MATCH_SUBSTRING,
+  HISTORY_MATCH_PREFIX
+} JShellHistoryMatch;
+
+
+// Called for each search match, oldest first
+typedef void (*JShellHistoryVisitor)(size_t index,
+                                     const JShellHistoryEntry *entry,
+                                     void *userdata);
+
+
+// Open and map ~/.jshell/history (in-memory only if that fails)
 void jshell_history_init(void);
+
+// Append a command; its status and duration are set by _finish()
 void jshell_history_add(const char *line);
+
+// Record the exit status and duration of the last added command
+void jshell_history_finish(int exit_status);
+
+// Number of entries, including those added by other sessions
 size_t jshell_history_count(void);
+
+// Command text of entry index (0 is the oldest), or NULL
 const char *jshell_history_get(size_t index);
 
+// Fill entry for index; returns 0 on success, -1 if out of range
+int jshell_history_get_entry(size_t index, JShellHistoryEntry *entry);
+
+// Visit every entry matching query; returns the number of matches
+size_t jshell_history_search(const char *query, JShellHistoryMatch mode,
+                             JShellHistoryVisitor visit, void *userdata);
+
 #endif
@@ -0,0 +1,177 @@
+/**
+ * @file jshell_io.c
+ * @brief Per-invocation standard streams for builtin commands.
+ *
+ * Each thread running a builtin installs a JShellIO describing where that
+ * builtin's stdin and stdout point. Builtins reach their streams through
+ * the accessors here, so redirections never touch the process-wide
+ * STDIN_FILENO/STDOUT_FILENO and concurrent builtins stay isolated.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include "jshell_io.h"
+#include "utils/jbox_utils.h"
+
+
+/** Streams installed for the calling thread, NULL for process streams */
+static thread_local const JShellIO* g_current_io = NULL;
+
+
+/**
+ * Build streams for an invocation from redirection descriptors.
+ * @param io Structure to initialize.
+ * @param input_fd Descriptor to read from, or -1 to use stdin.
+ * @param output_fd Descriptor to write to, or -1 to use stdout.
+ * @return 0 on success, -1 on failure (descriptors are closed).
+ */
+int jshell_io_open(JShellIO* io, int input_fd, int output_fd) {
+  return jshell_io_open_ends(io, input_fd, NULL, output_fd, NULL);
+}
+
+
+/**
+ * Build streams for an invocation from descriptors or ring pipe ends.
+ * @param io Structure to initialize.
+ * @param input_fd Descriptor to read from, or -1.
+ * @param input_ring Ring to read from, or NULL; with input_fd -1 as
+ *        well, stdin is used.
+ * @param output_fd Descriptor to write to, or -1.
+ * @param output_ring Ring to write to, or NULL; with output_fd -1 as
+ *        well, stdout is used.
+ * @return 0 on success, -1 on failure (descriptors and rings are closed).
+ */
+int jshell_io_open_ends(JShellIO* io, int input_fd, JShellRing* input_ring,
+                        int output_fd, JShellRing* output_ring) {
+  io->in = stdin;
+  io->out = stdout;
+  io->owns_in = false;
+  io->owns_out = false;
+  io->records_out = false;
+
+  if (input_ring != NULL || input_fd != -1) {
+    io->in = input_ring != NULL ? jshell_ring_open_reader(input_ring)
+                                : fdopen(input_fd, "r");
+    if (io->in == NULL) {
+      perror("fdopen input");
+      if (input_ring != NULL) {
+        jshell_ring_close_reader(input_ring);
+      } else {
+        close(input_fd);
+      }
+      if (output_ring != NULL) {
+        jshell_ring_close_writer(output_ring);
+      } else if (output_fd != -1) {
+        close(output_fd);
+      }
+      return -1;
+    }
+    io->owns_in = true;
+  }
+
+  if (output_ring != NULL || output_fd != -1) {
+    io->out = output_ring != NULL ? jshell_ring_open_writer(output_ring)
+                                  : fdopen(output_fd, "w");
+    if (io->out == NULL) {
+      perror("fdopen output");
+      if (output_ring != NULL) {
+        jshell_ring_close_writer(output_ring);
+      } else {
+        close(output_fd);
+      }
+      jshell_io_close(io);
+      return -1;
+    }
+    io->owns_out = true;
+  }
+
+  DPRINT("Opened builtin io: input_fd=%d, output_fd=%d%s%s", input_fd,
+         output_fd, input_ring != NULL ? ", input ring" : "",
+         output_ring != NULL ? ", output ring" : "");
+  return 0;
+}
+
+
+/**
+ * Flush output and close any streams opened by jshell_io_open.
+ * Closing the output stream is what delivers EOF to a downstream stage.
+ * @param io Streams to close.
+ */
+void jshell_io_close(JShellIO* io) {
+  if (io == NULL) {
+    return;
+  }
+
+  if (io->out != NULL) {
+    if (io->owns_out) {
+      fclose(io->out);
+    } else {
+      fflush(io->out);
+    }
+  }
+  if (io->in != NULL && io->owns_in) {
+    fclose(io->in);
+  }
+
+  io->in = NULL;
+  io->out = NULL;
+  io->owns_in = false;
+  io->owns_out = false;
+}
+
+
+/**
+ * Install streams for the calling thread.
+ * @param io Streams to install, or NULL to fall back to process streams.
+ * @return Previously installed streams.
+ */
+const JShellIO* jshell_io_set_current(const JShellIO* io) {
+  const JShellIO* previous = g_current_io;
+  g_current_io = io;
+  return previous;
+}
+
+
+/**
+ * Get the calling thread's input stream.
+ * @return Installed input stream, or stdin.
+ */
+FILE* jshell_io_stdin(void) {
+  return (g_current_io != NULL) ? g_current_io->in : stdin;
+}
+
+
+/**
+ * Get the calling thread's output stream.
+ * @return Installed output stream, or stdout.
+ */
+FILE* jshell_io_stdout(void) {
+  return (g_current_io != NULL) ? g_current_io->out : stdout;
+}
+
+
+/**
+ * Tell whether the calling thread's output goes to a stage reading
+ * records.
+ * @return true if the installed streams say so.
+ */
+bool jshell_io_records_out(void) {
+  return g_current_io != NULL && g_current_io->records_out;
+}
+
+
+/**
+ * printf() to the calling thread's output stream.
+ * @param fmt printf-style format string.
+ * @return Number of characters written, or negative on error.
+ */
+int jshell_printf(const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int written = vfprintf(jshell_io_stdout(), fmt, ap);
+  va_end(ap);
+  return written;
+}
@@ -0,0 +1,58 @@
+#ifndef JSHELL_IO_H
+#define JSHELL_IO_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "jshell_ring.h"
+
+
+// Standard streams for one builtin invocation
+// Builtins write through jshell_io_stdout()/jshell_printf() instead of
+// the process-wide stdout so that several builtins can run concurrently
+// on different threads, each with its own redirections.
+typedef struct {
+  FILE* in;
+  FILE* out;
+  bool owns_in;   // true if in was opened by jshell_io_open
+  bool owns_out;  // true if out was opened by jshell_io_open
+  bool records_out;  // The next pipeline stage reads jbox_record.h records
+} JShellIO;
+
+
+// Build streams for an invocation from redirection descriptors
+// input_fd/output_fd of -1 mean "inherit the process stdin/stdout"
+// Takes ownership of the descriptors (they are closed by jshell_io_close,
+// or immediately on failure)
+// Returns 0 on success, -1 on failure
+int jshell_io_open(JShellIO* io, int input_fd, int output_fd);
+
+// Like jshell_io_open(), but a non-NULL input_ring/output_ring is read
+// or written instead of the descriptor on that side (which is then -1)
+// Takes ownership of the ring ends as well
+int jshell_io_open_ends(JShellIO* io, int input_fd, JShellRing* input_ring,
+                        int output_fd, JShellRing* output_ring);
+
+// Flush output and close any streams opened by jshell_io_open
+void jshell_io_close(JShellIO* io);
+
+// Install io as the calling thread's current streams (NULL to reset)
+// Returns the previously installed streams so callers can nest
+const JShellIO* jshell_io_set_current(const JShellIO* io);
+
+// Current thread's input stream (process stdin if none installed)
+FILE* jshell_io_stdin(void);
+
+// Current thread's output stream (process stdout if none installed)
+FILE* jshell_io_stdout(void);
+
+// Whether the current thread's structured output may be written as
+// binary records (false if none installed)
+bool jshell_io_records_out(void);
+
+// printf() to the current thread's output stream
+int jshell_printf(const char* fmt, ...)
+  __attribute__((format(printf, 1, 2)));
+
+
+#endif
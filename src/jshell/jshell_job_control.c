@@ -1,12 +1,31 @@
 /**
  * @file jshell_job_control.c
  * @brief Background job management and process tracking for the shell.
+ *
+ * Jobs live in a growable table ordered by job ID and each running pid is
+ * indexed in a pid -> job hash, so reaping a child is a constant-time
+ * lookup however many jobs are active. SIGCHLD is blocked and delivered
+ * through a signalfd, which the prompt's event loop polls next to stdin;
+ * finished jobs are therefore noticed as soon as they exit. Where signalfd
+ * is unavailable a plain SIGCHLD handler sets a flag instead.
+ *
+ * Thread jobs, such as a background AI query or a builtin started with
+ * `&`, have no processes. Their thread records the outcome in a locked
+ * list and raises SIGCHLD itself, so the same wait notices them; the main
+ * thread then moves the outcome into the job table.
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <poll.h>
 #include <signal.h>
+#include <pthread.h>
+#include <time.h>
 #include <unistd.h>
 #include <errno.h>
 
@@ -15,8 +34,22 @@
 #include "utils/jbox_utils.h"
 
 
-/** Array of background jobs tracked by the shell. */
-static BackgroundJob job_list[MAX_JOBS];
+/** A running pid and the job it belongs to */
+typedef struct PidEntry {
+  pid_t pid;
+  BackgroundJob* job;
+  size_t index;              /* Position of the pid within the job */
+  struct PidEntry* next;
+} PidEntry;
+
+
+/** Background jobs tracked by the shell, in job ID order. */
+static BackgroundJob** job_list = NULL;
+static size_t job_count = 0;
+static size_t job_capacity = 0;
+
+/** Hash of running pids. */
+static PidEntry* pid_buckets[JOB_PID_BUCKETS];
 
 /** Counter for assigning unique job IDs. */
 static int next_job_id = 1;
@@ -24,6 +57,31 @@ static int next_job_id = 1;
 /** Flag set by SIGCHLD handler to indicate child process state change. */
 static volatile sig_atomic_t sigchld_received = 0;
 
+/** signalfd receiving SIGCHLD, or -1 if the handler flag is used. */
+static int sigchld_fd = -1;
+
+/** Outcome of a thread job, filled in by its thread */
+typedef struct ThreadResult {
+  int job_id;
+  bool done;
+  int exit_code;
+  char* output;
+  JShellUsage usage;
+  struct ThreadResult* next;
+} ThreadResult;
+
+/** Thread jobs not yet moved to the table as done, under thread_lock */
+static ThreadResult* thread_results = NULL;
+static pthread_mutex_t thread_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** How long a finished job's output may take to arrive when reported */
+#define SPOOL_REPORT_WAIT_MS 100
+
+/** Only the shell's main thread reaps; builtin threads must not steal
+ *  the children a foreground pipeline is waiting for. */
+static pthread_t main_thread;
+static bool job_control_initialized = false;
+
 
 /**
  * SIGCHLD signal handler.
@@ -38,19 +96,13 @@ static void sigchld_handler(int sig) {
 
 /**
  * Initialize the job control subsystem.
- * Clears the job list and installs the SIGCHLD signal handler.
+ * Installs the SIGCHLD handler, then blocks SIGCHLD and opens a signalfd
+ * for it. Must run before any threads are started so they inherit the
+ * blocked mask.
  */
 void jshell_init_job_control(void) {
   DPRINT("jshell_init_job_control called");
 
-  for (int i = 0; i < MAX_JOBS; i++) {
-    job_list[i].in_use = false;
-    job_list[i].job_id = 0;
-    job_list[i].pid_count = 0;
-    job_list[i].status = JOB_RUNNING;
-    job_list[i].cmd_string[0] = '\0';
-  }
-
   struct sigaction sa;
   sa.sa_handler = sigchld_handler;
   sigemptyset(&sa.sa_mask);
@@ -60,7 +112,166 @@ void jshell_init_job_control(void) {
     perror("sigaction");
   }
 
-  DPRINT("Job control initialized with SIGCHLD handler");
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  if (pthread_sigmask(SIG_BLOCK, &mask, NULL) == 0) {
+    sigchld_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sigchld_fd == -1) {
+      perror("signalfd");
+      pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+    }
+  }
+
+  main_thread = pthread_self();
+  job_control_initialized = true;
+
+  DPRINT("Job control initialized (%s)",
+         sigchld_fd >= 0 ? "signalfd" : "SIGCHLD handler");
+}
+
+
+/**
+ * Get the descriptor that becomes readable when a child changes state.
+ * @return signalfd for SIGCHLD, or -1 if none is in use.
+ */
+int jshell_job_control_fd(void) {
+  return sigchld_fd;
+}
+
+
+/**
+ * Hash a pid to its bucket.
+ * @param pid Process ID.
+ * @return Bucket index.
+ */
+static size_t pid_bucket(pid_t pid) {
+  return (size_t)pid & (JOB_PID_BUCKETS - 1);
+}
+
+
+/**
+ * Find the hash entry of a running pid.
+ * @param pid Process ID.
+ * @return Entry, or NULL if the pid belongs to no running job.
+ */
+static PidEntry* pid_lookup(pid_t pid) {
+  for (PidEntry* entry = pid_buckets[pid_bucket(pid)]; entry != NULL;
+       entry = entry->next) {
+    if (entry->pid == pid) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+
+/**
+ * Remove a job's entry for a pid from the hash.
+ * @param pid Process ID.
+ * @param job Job the entry must belong to.
+ */
+static void pid_remove(pid_t pid, const BackgroundJob* job) {
+  PidEntry** link = &pid_buckets[pid_bucket(pid)];
+  while (*link != NULL) {
+    PidEntry* entry = *link;
+    if (entry->pid == pid && entry->job == job) {
+      *link = entry->next;
+      free(entry);
+      return;
+    }
+    link = &entry->next;
+  }
+}
+
+
+/**
+ * Free a job and any hash entries it still owns.
+ * @param job Job to free.
+ */
+static void free_job(BackgroundJob* job) {
+  for (size_t i = 0; i < job->pid_count; i++) {
+    if (job->pid_statuses[i] == -1) {
+      pid_remove(job->pids[i], job);
+    }
+  }
+  free(job->pids);
+  free(job->pid_statuses);
+  free(job->pid_usage);
+  free(job->cmd_string);
+  free(job->output);
+  jshell_spool_free(job->spool);
+  jshell_sched_free(&job->sched);
+  free(job);
+}
+
+
+/**
+ * Convert a wait status to a shell exit status.
+ * @param status Wait status from wait4().
+ * @return Exit code, or 128 + signal number.
+ */
+static int exit_code_from_status(int status) {
+  if (WIFEXITED(status)) {
+    return WEXITSTATUS(status);
+  }
+  if (WIFSIGNALED(status)) {
+    return 128 + WTERMSIG(status);
+  }
+  return 0;
+}
+
+
+/**
+ * Record that one process of a job has terminated.
+ * @param job Job owning the process.
+ * @param index Position of the process in the job.
+ * @param exit_code Exit status of the process.
+ * @param ru Resource usage reported by wait4(), or NULL if unknown.
+ * @return true if this completed the job.
+ */
+static bool mark_pid_done(BackgroundJob* job, size_t index, int exit_code,
+                          const struct rusage* ru) {
+  if (job->pid_statuses[index] != -1) {
+    return false;
+  }
+
+  uint64_t now = jshell_usage_now();
+  job->pid_statuses[index] = exit_code;
+  job->pids_done++;
+  job->pid_usage[index].wall_us = now - job->start_us;
+  if (ru != NULL) {
+    jshell_usage_from_rusage(&job->pid_usage[index], ru);
+  }
+  pid_remove(job->pids[index], job);
+
+  if (job->pids_done == job->pid_count) {
+    job->status = JOB_DONE;
+    job->end_us = now;
+    DPRINT("Job [%d] marked as DONE", job->job_id);
+    return true;
+  }
+  return false;
+}
+
+
+/**
+ * Make room in the job table for one more job.
+ * @return 0 on success, -1 if the table cannot grow.
+ */
+static int reserve_job_slot(void) {
+  if (job_count == job_capacity) {
+    size_t new_capacity = (job_capacity == 0) ? 16 : job_capacity * 2;
+    BackgroundJob** grown = realloc(job_list,
+                                    new_capacity * sizeof(BackgroundJob*));
+    if (grown == NULL) {
+      fprintf(stderr, "jshell: job table full\n");
+      return -1;
+    }
+    job_list = grown;
+    job_capacity = new_capacity;
+  }
+  return 0;
 }
 
 
@@ -69,46 +280,81 @@ void jshell_init_job_control(void) {
  * @param pids Array of process IDs in the job (pipeline).
  * @param pid_count Number of processes in the job.
  * @param cmd_string Command string for display purposes.
+ * @param sched Placement the processes were started with, or NULL.
  * @return Job ID on success, -1 on failure.
  */
 int jshell_add_background_job(pid_t* pids, size_t pid_count,
-                               const char* cmd_string) {
+                               const char* cmd_string,
+                               const JShellSched* sched) {
   DPRINT("jshell_add_background_job called with %zu pids", pid_count);
 
-  if (pids == NULL || pid_count == 0 || pid_count > MAX_PIDS_PER_JOB) {
+  if (pids == NULL || pid_count == 0) {
     return -1;
   }
 
-  int slot = -1;
-  for (int i = 0; i < MAX_JOBS; i++) {
-    if (!job_list[i].in_use) {
-      slot = i;
-      break;
-    }
+  if (reserve_job_slot() != 0) {
+    return -1;
+  }
+
+  BackgroundJob* job = calloc(1, sizeof(BackgroundJob));
+  PidEntry** entries = calloc(pid_count, sizeof(PidEntry*));
+  if (job != NULL) {
+    job->pids = malloc(pid_count * sizeof(pid_t));
+    job->pid_statuses = malloc(pid_count * sizeof(int));
+    job->pid_usage = calloc(pid_count, sizeof(JShellUsage));
+    job->cmd_string = strdup(cmd_string != NULL ? cmd_string : "");
   }
 
-  if (slot == -1) {
-    fprintf(stderr, "jshell: job table full\n");
+  bool ok = job != NULL && entries != NULL && job->pids != NULL
+            && job->pid_statuses != NULL && job->pid_usage != NULL
+            && job->cmd_string != NULL
+            && jshell_sched_copy(&job->sched, sched) == 0;
+  for (size_t i = 0; ok && i < pid_count; i++) {
+    entries[i] = malloc(sizeof(PidEntry));
+    ok = entries[i] != NULL;
+  }
+
+  if (!ok) {
+    perror("jshell: add background job");
+    if (entries != NULL) {
+      for (size_t i = 0; i < pid_count; i++) {
+        free(entries[i]);
+      }
+      free(entries);
+    }
+    if (job != NULL) {
+      free(job->pids);
+      free(job->pid_statuses);
+      free(job->pid_usage);
+      free(job->cmd_string);
+      jshell_sched_free(&job->sched);
+      free(job);
+    }
     return -1;
   }
 
-  BackgroundJob* job = &job_list[slot];
   job->job_id = next_job_id++;
   job->pid_count = pid_count;
+  job->status = JOB_RUNNING;
+  job->start_us = jshell_usage_now();
+  atomic_init(&job->cancelled, false);
 
+  /* Newest entries go first so a recycled pid resolves to its new job */
   for (size_t i = 0; i < pid_count; i++) {
     job->pids[i] = pids[i];
+    job->pid_statuses[i] = -1;
+
+    PidEntry* entry = entries[i];
+    size_t bucket = pid_bucket(pids[i]);
+    entry->pid = pids[i];
+    entry->job = job;
+    entry->index = i;
+    entry->next = pid_buckets[bucket];
+    pid_buckets[bucket] = entry;
   }
+  free(entries);
 
-  if (cmd_string != NULL) {
-    strncpy(job->cmd_string, cmd_string, MAX_CMD_STRING - 1);
-    job->cmd_string[MAX_CMD_STRING - 1] = '\0';
-  } else {
-    job->cmd_string[0] = '\0';
-  }
-
-  job->status = JOB_RUNNING;
-  job->in_use = true;
+  job_list[job_count++] = job;
 
   printf("[%d] %d\n", job->job_id, job->pids[0]);
 
@@ -120,98 +366,402 @@ int jshell_add_background_job(pid_t* pids, size_t pid_count,
 
 
 /**
- * Find a background job containing the given process ID.
- * @param pid Process ID to search for.
- * @return Pointer to BackgroundJob if found, NULL otherwise.
+ * Add a job run by a thread of the shell to the job table.
+ *
+ * The job has no pids; its thread reports the outcome with
+ * jshell_finish_thread_job() and may poll job->cancelled to stop early.
+ *
+ * @param cmd_string Command string for display purposes.
+ * @return Job ID on success, -1 on failure.
  */
-BackgroundJob* jshell_find_job_by_pid(pid_t pid) {
-  for (int i = 0; i < MAX_JOBS; i++) {
-    if (!job_list[i].in_use) {
-      continue;
-    }
+int jshell_add_thread_job(const char* cmd_string) {
+  DPRINT("jshell_add_thread_job called");
 
-    for (size_t j = 0; j < job_list[i].pid_count; j++) {
-      if (job_list[i].pids[j] == pid) {
-        return &job_list[i];
-      }
+  if (reserve_job_slot() != 0) {
+    return -1;
+  }
+
+  BackgroundJob* job = calloc(1, sizeof(BackgroundJob));
+  ThreadResult* result = calloc(1, sizeof(ThreadResult));
+  if (job != NULL) {
+    job->cmd_string = strdup(cmd_string != NULL ? cmd_string : "");
+  }
+  if (job == NULL || result == NULL || job->cmd_string == NULL) {
+    perror("jshell: add background job");
+    if (job != NULL) {
+      free(job->cmd_string);
     }
+    free(job);
+    free(result);
+    return -1;
   }
 
-  return NULL;
+  job->job_id = next_job_id++;
+  job->status = JOB_RUNNING;
+  job->start_us = jshell_usage_now();
+  atomic_init(&job->cancelled, false);
+  job_list[job_count++] = job;
+
+  /* Allocated now so finishing cannot fail */
+  result->job_id = job->job_id;
+  pthread_mutex_lock(&thread_lock);
+  result->next = thread_results;
+  thread_results = result;
+  pthread_mutex_unlock(&thread_lock);
+
+  printf("[%d]\n", job->job_id);
+
+  DPRINT("Added thread job [%d]", job->job_id);
+
+  return job->job_id;
 }
 
 
 /**
- * Update the status of a job based on a child process status change.
- * Checks if all processes in the job have finished, and marks job as done.
- * @param pid Process ID that changed status.
- * @param status Wait status from waitpid().
+ * Record the outcome of a thread job and wake the main thread.
+ *
+ * Raising SIGCHLD makes the prompt's wait return just as when a child
+ * exits; the reap that follows finds no children but the finished job.
+ * Must be called from the job's thread, whose CPU time is recorded.
+ *
+ * @param job_id Job ID returned by jshell_add_thread_job().
+ * @param exit_code Exit status of the job.
+ * @param output Text to print when the job is reported, or NULL; freed
+ *               along with the job.
  */
-void jshell_update_job_status(pid_t pid, int status) {
-  DPRINT("jshell_update_job_status called for pid %d", pid);
+void jshell_finish_thread_job(int job_id, int exit_code, char* output) {
+  JShellUsage usage = {0};
+  jshell_usage_of_thread(&usage);
+
+  pthread_mutex_lock(&thread_lock);
+  ThreadResult* result = thread_results;
+  while (result != NULL && result->job_id != job_id) {
+    result = result->next;
+  }
+  if (result != NULL) {
+    result->done = true;
+    result->exit_code = exit_code;
+    result->output = output;
+    result->usage = usage;
+    output = NULL;
+  }
+  pthread_mutex_unlock(&thread_lock);
 
-  BackgroundJob* job = jshell_find_job_by_pid(pid);
+  free(output);
+  kill(getpid(), SIGCHLD);
+}
+
+
+/**
+ * Find a job in the table by ID.
+ * @param job_id Job ID.
+ * @return Job, or NULL if there is none.
+ */
+static BackgroundJob* job_lookup(int job_id) {
+  /* The table is ordered by job ID */
+  size_t lo = 0;
+  size_t hi = job_count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    BackgroundJob* job = job_list[mid];
+    if (job->job_id == job_id) {
+      return job;
+    }
+    if (job->job_id < job_id) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return NULL;
+}
+
+
+/**
+ * Hand a job the spool its output is written to.
+ * @param job_id Job ID, or -1 if the job could not be added.
+ * @param spool Spool taking the job's output; owned by the job from now.
+ */
+void jshell_job_set_spool(int job_id, JShellSpool* spool) {
+  BackgroundJob* job = job_id > 0 ? job_lookup(job_id) : NULL;
   if (job == NULL) {
-    DPRINT("No job found for pid %d", pid);
+    jshell_spool_free(spool);
     return;
   }
+  jshell_spool_free(job->spool);
+  job->spool = spool;
+}
 
-  if (WIFEXITED(status) || WIFSIGNALED(status)) {
-    bool all_done = true;
-
-    for (size_t i = 0; i < job->pid_count; i++) {
-      int child_status;
-      pid_t result = waitpid(job->pids[i], &child_status, WNOHANG);
 
-      if (result == 0) {
-        all_done = false;
-        break;
-      }
+/**
+ * Move the outcome of finished thread jobs into the job table.
+ * @return Number of jobs that finished.
+ */
+static size_t collect_thread_jobs(void) {
+  size_t finished = 0;
+
+  pthread_mutex_lock(&thread_lock);
+  ThreadResult** link = &thread_results;
+  while (*link != NULL) {
+    ThreadResult* result = *link;
+    if (!result->done) {
+      link = &result->next;
+      continue;
     }
 
-    if (all_done) {
+    BackgroundJob* job = job_lookup(result->job_id);
+    if (job != NULL) {
+      job->exit_code = result->exit_code;
+      job->output = result->output;
+      job->usage = result->usage;
+      job->end_us = jshell_usage_now();
+      job->usage.wall_us = job->end_us - job->start_us;
       job->status = JOB_DONE;
-      DPRINT("Job [%d] marked as DONE", job->job_id);
+      finished++;
+      DPRINT("Thread job [%d] marked as DONE", job->job_id);
+    } else {
+      free(result->output);
     }
-  } else if (WIFSTOPPED(status)) {
+    *link = result->next;
+    free(result);
+  }
+  pthread_mutex_unlock(&thread_lock);
+
+  return finished;
+}
+
+
+/**
+ * Find a background job containing the given running process ID.
+ * @param pid Process ID to search for.
+ * @return Pointer to BackgroundJob if found, NULL otherwise.
+ */
+BackgroundJob* jshell_find_job_by_pid(pid_t pid) {
+  PidEntry* entry = pid_lookup(pid);
+  return entry != NULL ? entry->job : NULL;
+}
+
+
+/**
+ * Record a child state change reported by wait4().
+ * @param pid Process ID that changed status.
+ * @param status Wait status from wait4().
+ * @param ru Resource usage from wait4(), or NULL if unknown.
+ * @return true if this completed the pid's job.
+ */
+static bool record_child_status(pid_t pid, int status,
+                                const struct rusage* ru) {
+  PidEntry* entry = pid_lookup(pid);
+  if (entry == NULL) {
+    DPRINT("No job found for pid %d", pid);
+    return false;
+  }
+
+  BackgroundJob* job = entry->job;
+  if (WIFEXITED(status) || WIFSIGNALED(status)) {
+    return mark_pid_done(job, entry->index, exit_code_from_status(status),
+                         ru);
+  }
+
+  if (WIFSTOPPED(status)) {
     job->status = JOB_STOPPED;
     DPRINT("Job [%d] marked as STOPPED", job->job_id);
   }
+  return false;
 }
 
 
 /**
- * Check for background job status changes and reap finished processes.
- * Should be called periodically in the shell's main loop.
+ * Update the status of a job based on a child process status change.
+ * Marks the job as done once all of its processes have terminated.
+ * @param pid Process ID that changed status.
+ * @param status Wait status from waitpid().
  */
-void jshell_check_background_jobs(void) {
-  if (!sigchld_received) {
-    return;
+void jshell_update_job_status(pid_t pid, int status) {
+  DPRINT("jshell_update_job_status called for pid %d", pid);
+  record_child_status(pid, status, NULL);
+}
+
+
+/**
+ * Reap the terminated processes of background jobs, leaving other
+ * children alone.
+ * @return Number of jobs that finished.
+ */
+static size_t reap_job_pids(void) {
+  size_t finished = 0;
+
+  for (size_t i = 0; i < job_count; i++) {
+    BackgroundJob* job = job_list[i];
+    for (size_t p = 0; p < job->pid_count; p++) {
+      int status;
+      struct rusage ru;
+      if (job->pid_statuses[p] == -1
+          && wait4(job->pids[p], &status, WNOHANG, &ru) > 0
+          && record_child_status(job->pids[p], status, &ru)) {
+        finished++;
+      }
+    }
   }
+  return finished;
+}
 
-  sigchld_received = 0;
 
-  DPRINT("jshell_check_background_jobs called");
+/**
+ * Reap terminated background processes without reporting them.
+ *
+ * Cheap when nothing happened: the signalfd read fails with EAGAIN and no
+ * waitpid() is issued. Does nothing outside the main thread.
+ *
+ * @return Number of jobs that finished.
+ */
+size_t jshell_reap_background_jobs(void) {
+  if (!job_control_initialized
+      || !pthread_equal(pthread_self(), main_thread)) {
+    return 0;
+  }
+
+  if (sigchld_fd >= 0) {
+    struct signalfd_siginfo info;
+    bool signalled = false;
+    while (read(sigchld_fd, &info, sizeof(info)) == sizeof(info)) {
+      signalled = true;
+    }
+    if (!signalled) {
+      return 0;
+    }
+  } else {
+    if (!sigchld_received) {
+      return 0;
+    }
+    sigchld_received = 0;
+  }
+
+  size_t finished = collect_thread_jobs();
+
+  /* A builtin running as a thread job may wait for children of its own
+   * (parallel's workers), so only the jobs' pids are reaped meanwhile */
+  pthread_mutex_lock(&thread_lock);
+  bool threads_running = thread_results != NULL;
+  pthread_mutex_unlock(&thread_lock);
+  if (threads_running) {
+    return finished + reap_job_pids();
+  }
 
   pid_t pid;
   int status;
-
-  while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+  struct rusage ru;
+  while ((pid = wait4(-1, &status, WNOHANG, &ru)) > 0) {
     DPRINT("Reaped process %d", pid);
-    jshell_update_job_status(pid, status);
+    if (record_child_status(pid, status, &ru)) {
+      finished++;
+    }
   }
 
-  for (int i = 0; i < MAX_JOBS; i++) {
-    if (!job_list[i].in_use) {
-      continue;
+  return finished;
+}
+
+
+/**
+ * Print the output of a finished thread job, ending it with a newline.
+ * @param job Job whose output is printed and freed.
+ */
+static void print_job_output(BackgroundJob* job) {
+  size_t len = strlen(job->output);
+  fputs(job->output, stdout);
+  if (len > 0 && job->output[len - 1] != '\n') {
+    putchar('\n');
+  }
+  free(job->output);
+  job->output = NULL;
+}
+
+
+/**
+ * Print the output a finished job's spool kept, and free the spool.
+ * Output still in flight is waited for briefly; a process the job left
+ * behind may hold the pipe open for longer.
+ * @param job Job with a spool.
+ */
+static void print_spooled_output(BackgroundJob* job) {
+  jshell_spool_wait(job->spool, SPOOL_REPORT_WAIT_MS);
+
+  size_t len = 0;
+  uint64_t dropped = 0;
+  char* data = jshell_spool_read(job->spool, &len, &dropped, NULL);
+  if (dropped > 0) {
+    printf("[%d]  (%llu earlier bytes of output dropped)\n", job->job_id,
+           (unsigned long long)dropped);
+  }
+  if (data != NULL) {
+    fwrite(data, 1, len, stdout);
+    if (len > 0 && data[len - 1] != '\n') {
+      putchar('\n');
     }
+    free(data);
+  }
+  jshell_spool_free(job->spool);
+  job->spool = NULL;
+}
+
+
+/**
+ * Drop jobs that are finished from the table.
+ * @param report Print a Done line for each finished job not collected by
+ *               `wait`.
+ */
+static void sweep_jobs(bool report) {
+  size_t kept = 0;
+
+  for (size_t i = 0; i < job_count; i++) {
+    BackgroundJob* job = job_list[i];
 
-    if (job_list[i].status == JOB_DONE) {
-      printf("[%d]  Done                    %s\n",
-             job_list[i].job_id,
-             job_list[i].cmd_string);
-      job_list[i].in_use = false;
+    if (job->waited || job->status == JOB_DONE) {
+      if (job->output != NULL && !job->waited) {
+        print_job_output(job);
+      }
+      if (job->spool != NULL && !job->waited) {
+        print_spooled_output(job);
+      }
+      if (report && !job->waited) {
+        printf("[%d]  Done                    %s\n",
+               job->job_id, job->cmd_string);
+      }
+      DPRINT("Cleaning up job [%d]", job->job_id);
+      free_job(job);
+      continue;
     }
+
+    job_list[kept++] = job;
+  }
+
+  job_count = kept;
+}
+
+
+/**
+ * Check for background job status changes and reap finished processes.
+ * Should be called periodically in the shell's main loop.
+ */
+void jshell_check_background_jobs(void) {
+  DPRINT("jshell_check_background_jobs called");
+
+  jshell_reap_background_jobs();
+  sweep_jobs(true);
+}
+
+
+/**
+ * Converts job status enum to string representation.
+ * @param status Job status enum value.
+ * @return String representation of status.
+ */
+static const char* job_status_string(JobStatus status) {
+  switch (status) {
+    case JOB_RUNNING: return "Running";
+    case JOB_STOPPED: return "Stopped";
+    case JOB_DONE:    return "Done";
+    default:          return "Unknown";
   }
 }
 
@@ -223,35 +773,20 @@ void jshell_check_background_jobs(void) {
 void jshell_print_jobs(void) {
   DPRINT("jshell_print_jobs called");
 
+  jshell_reap_background_jobs();
+
   bool found_any = false;
 
-  for (int i = 0; i < MAX_JOBS; i++) {
-    if (!job_list[i].in_use) {
+  for (size_t i = 0; i < job_count; i++) {
+    if (job_list[i]->waited) {
       continue;
     }
 
     found_any = true;
-
-    const char* status_str;
-    switch (job_list[i].status) {
-      case JOB_RUNNING:
-        status_str = "Running";
-        break;
-      case JOB_STOPPED:
-        status_str = "Stopped";
-        break;
-      case JOB_DONE:
-        status_str = "Done";
-        break;
-      default:
-        status_str = "Unknown";
-        break;
-    }
-
     printf("[%d]  %-23s %s\n",
-           job_list[i].job_id,
-           status_str,
-           job_list[i].cmd_string);
+           job_list[i]->job_id,
+           job_status_string(job_list[i]->status),
+           job_list[i]->cmd_string);
   }
 
   if (!found_any) {
@@ -266,17 +801,7 @@ void jshell_print_jobs(void) {
  */
 void jshell_cleanup_finished_jobs(void) {
   DPRINT("jshell_cleanup_finished_jobs called");
-
-  for (int i = 0; i < MAX_JOBS; i++) {
-    if (!job_list[i].in_use) {
-      continue;
-    }
-
-    if (job_list[i].status == JOB_DONE) {
-      DPRINT("Cleaning up job [%d]", job_list[i].job_id);
-      job_list[i].in_use = false;
-    }
-  }
+  sweep_jobs(false);
 }
 
 
@@ -286,12 +811,10 @@ void jshell_cleanup_finished_jobs(void) {
  * @return Pointer to BackgroundJob if found, NULL otherwise.
  */
 BackgroundJob* jshell_find_job_by_id(int job_id) {
-  for (int i = 0; i < MAX_JOBS; i++) {
-    if (job_list[i].in_use && job_list[i].job_id == job_id) {
-      return &job_list[i];
-    }
-  }
-  return NULL;
+  jshell_reap_background_jobs();
+
+  BackgroundJob* job = job_lookup(job_id);
+  return job != NULL && !job->waited ? job : NULL;
 }
 
 
@@ -300,9 +823,11 @@ BackgroundJob* jshell_find_job_by_id(int job_id) {
  * @return Count of jobs currently in the job table.
  */
 size_t jshell_get_job_count(void) {
+  jshell_reap_background_jobs();
+
   size_t count = 0;
-  for (int i = 0; i < MAX_JOBS; i++) {
-    if (job_list[i].in_use) {
+  for (size_t i = 0; i < job_count; i++) {
+    if (!job_list[i]->waited) {
       count++;
     }
   }
@@ -312,62 +837,284 @@ size_t jshell_get_job_count(void) {
 
 /**
  * Iterate over all active jobs and invoke a callback for each.
+ * The callback may wait for the job it is given.
  * @param callback Function to call for each job.
  * @param userdata User-defined data passed to the callback.
  */
 void jshell_for_each_job(void (*callback)(const BackgroundJob *job,
                                           void *userdata),
                          void *userdata) {
-  for (int i = 0; i < MAX_JOBS; i++) {
-    if (job_list[i].in_use) {
-      callback(&job_list[i], userdata);
+  jshell_reap_background_jobs();
+
+  for (size_t i = 0; i < job_count; i++) {
+    if (!job_list[i]->waited) {
+      callback(job_list[i], userdata);
+    }
+  }
+}
+
+
+/**
+ * Check whether every process (or the thread) of a job has finished.
+ * @param job Job to check.
+ * @return true if the job is done.
+ */
+static bool job_finished(const BackgroundJob* job) {
+  return job->status == JOB_DONE
+         || (job->pid_count > 0 && job->pids_done == job->pid_count);
+}
+
+
+/**
+ * Collect a finished job for `wait`: print a thread job's output and mark
+ * the job so it is dropped without a Done notice.
+ * @param job Finished job.
+ * @return Exit status of the job (of its last process for pipelines).
+ */
+static int collect_job(BackgroundJob* job) {
+  int status;
+  if (job->pid_count == 0) {
+    if (job->output != NULL) {
+      print_job_output(job);
+    }
+    status = job->exit_code;
+  } else {
+    status = job->pid_statuses[job->pid_count - 1];
+  }
+  if (job->spool != NULL) {
+    print_spooled_output(job);
+  }
+
+  /* Freed by the next sweep; callers may still be iterating the table */
+  job->status = JOB_DONE;
+  job->waited = true;
+  return status;
+}
+
+
+/**
+ * Open a pidfd for a process, or -1 where pidfds are not supported.
+ * @param pid Process ID.
+ * @return Descriptor that becomes readable when the process exits.
+ */
+int jshell_open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+  return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+  (void)pid;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+
+/** A pidfd being polled for a process of a selected job */
+typedef struct {
+  BackgroundJob* job;
+  size_t index;              /* Position of the pid within the job */
+} PidWatch;
+
+
+/**
+ * Wait for a set of background jobs without blocking on any one of them.
+ *
+ * Each running process gets a pidfd, polled together with the SIGCHLD
+ * signalfd (which also announces thread jobs), so the wait returns as soon
+ * as the first job (any) or the last one finishes, or the timeout passes.
+ * Where pidfds are unavailable the signalfd alone drives the wait, and
+ * without either the wait wakes every 50 ms to reap.
+ *
+ * @param job_ids Jobs to wait for; each must exist.
+ * @param count Number of jobs.
+ * @param any Return once one job has finished, collecting only that job
+ *            (the lowest listed one if several are done).
+ * @param timeout_ms Longest wait in milliseconds, or negative for none.
+ * @param statuses Exit status of each collected job, -1 for the others.
+ * @return How the wait ended.
+ */
+JobWaitResult jshell_wait_for_job_set(const int* job_ids, size_t count,
+                                      bool any, int timeout_ms,
+                                      int* statuses) {
+  BackgroundJob** jobs = calloc(count ? count : 1, sizeof(BackgroundJob*));
+  size_t watch_cap = 1;
+  for (size_t i = 0; i < count; i++) {
+    statuses[i] = -1;
+    jobs[i] = jobs != NULL ? jshell_find_job_by_id(job_ids[i]) : NULL;
+    watch_cap += jobs[i] != NULL ? jobs[i]->pid_count : 0;
+  }
+
+  struct pollfd* fds = calloc(watch_cap, sizeof(struct pollfd));
+  PidWatch* watches = calloc(watch_cap, sizeof(PidWatch));
+  if (jobs == NULL || fds == NULL || watches == NULL) {
+    free(jobs);
+    free(fds);
+    free(watches);
+    return JOB_WAIT_ERROR;
+  }
+
+  /* Slot 0 is the signalfd; poll() skips negative descriptors */
+  size_t nfds = 1;
+  fds[0].fd = sigchld_fd;
+  fds[0].events = POLLIN;
+  for (size_t i = 0; i < count; i++) {
+    for (size_t p = 0; jobs[i] != NULL && p < jobs[i]->pid_count; p++) {
+      if (jobs[i]->pid_statuses[p] != -1) {
+        continue;
+      }
+      fds[nfds].fd = jshell_open_pidfd(jobs[i]->pids[p]);
+      fds[nfds].events = POLLIN;
+      watches[nfds].job = jobs[i];
+      watches[nfds].index = p;
+      nfds++;
+    }
+  }
+
+  uint64_t deadline = timeout_ms >= 0
+                      ? jshell_usage_now() + (uint64_t)timeout_ms * 1000 : 0;
+  JobWaitResult result;
+
+  while (true) {
+    jshell_reap_background_jobs();
+
+    size_t pending = 0;
+    bool collected = false;
+    for (size_t i = 0; i < count; i++) {
+      if (jobs[i] == NULL || statuses[i] != -1) {
+        continue;
+      }
+      if (job_finished(jobs[i]) && !(any && collected)) {
+        statuses[i] = collect_job(jobs[i]);
+        collected = true;
+      } else {
+        pending++;
+      }
+    }
+    if (any ? collected || count == 0 : pending == 0) {
+      result = JOB_WAIT_DONE;
+      break;
+    }
+
+    int wait_ms = -1;
+    if (timeout_ms >= 0) {
+      uint64_t now = jshell_usage_now();
+      if (now >= deadline) {
+        result = JOB_WAIT_TIMEOUT;
+        break;
+      }
+      wait_ms = (int)((deadline - now + 999) / 1000);
+    }
+    bool watched = false;
+    for (size_t f = 0; f < nfds && !watched; f++) {
+      watched = fds[f].fd >= 0;
+    }
+    if (!watched && (wait_ms < 0 || wait_ms > 50)) {
+      wait_ms = 50;
+    }
+
+    if (poll(fds, nfds, wait_ms) == -1) {
+      if (errno != EINTR) {
+        result = JOB_WAIT_ERROR;
+        break;
+      }
+      if (jshell_is_interrupted()) {
+        result = JOB_WAIT_INTERRUPTED;
+        break;
+      }
+      continue;
+    }
+
+    /* Reap exited processes directly; the signalfd is drained above */
+    for (size_t f = 1; f < nfds; f++) {
+      if (fds[f].fd < 0 || !(fds[f].revents & (POLLIN | POLLHUP))) {
+        continue;
+      }
+      BackgroundJob* job = watches[f].job;
+      size_t index = watches[f].index;
+      int status;
+      struct rusage ru;
+      if (job->pid_statuses[index] == -1
+          && wait4(job->pids[index], &status, WNOHANG, &ru) > 0) {
+        mark_pid_done(job, index, exit_code_from_status(status), &ru);
+      }
+      close(fds[f].fd);
+      fds[f].fd = -1;
     }
   }
+
+  for (size_t f = 1; f < nfds; f++) {
+    if (fds[f].fd >= 0) {
+      close(fds[f].fd);
+    }
+  }
+  free(fds);
+  free(watches);
+  free(jobs);
+  DPRINT("Waited for %zu jobs (any=%d): result %d", count, any, result);
+  return result;
 }
 
 
 /**
  * Wait for a specific background job to complete.
- * Blocks until all processes in the job have finished.
+ * Blocks until all processes in the job have finished. Processes already
+ * reaped through SIGCHLD keep their recorded status.
  * @param job_id Job ID to wait for.
  * @return Exit status of last process in job, -1 if job not found,
  *         -2 if interrupted by SIGINT.
  */
 int jshell_wait_for_job(int job_id) {
-  BackgroundJob *job = jshell_find_job_by_id(job_id);
-  if (job == NULL) {
+  if (jshell_find_job_by_id(job_id) == NULL) {
     return -1;
   }
 
-  int final_status = 0;
-  for (size_t i = 0; i < job->pid_count; i++) {
-    int status;
-    pid_t result;
-
-    /* Loop until waitpid succeeds or we're interrupted */
-    while ((result = waitpid(job->pids[i], &status, 0)) == -1) {
-      if (errno == EINTR) {
-        /* Check if we should abort due to signal */
-        if (jshell_is_interrupted()) {
-          return -2;  /* Interrupted by SIGINT */
-        }
-        /* Otherwise, continue waiting */
-        continue;
-      }
-      /* Some other error occurred */
-      break;
-    }
+  int status;
+  JobWaitResult result = jshell_wait_for_job_set(&job_id, 1, false, -1,
+                                                 &status);
+  if (result == JOB_WAIT_INTERRUPTED) {
+    return -2;  /* Interrupted by SIGINT */
+  }
+  return status >= 0 ? status : 0;
+}
+
 
-    if (result > 0) {
-      if (WIFEXITED(status)) {
-        final_status = WEXITSTATUS(status);
-      } else if (WIFSIGNALED(status)) {
-        final_status = 128 + WTERMSIG(status);
+/**
+ * Get the usage of one process of a job.
+ * @param job Job owning the process.
+ * @param index Position of the process in the job.
+ * @param usage Usage to fill in.
+ * @return true on success, false if a running pid cannot be read.
+ */
+bool jshell_job_pid_usage(const BackgroundJob* job, size_t index,
+                          JShellUsage* usage) {
+  if (job->pid_statuses[index] != -1) {
+    *usage = job->pid_usage[index];
+    return true;
+  }
+
+  *usage = (JShellUsage){0};
+  usage->wall_us = jshell_usage_now() - job->start_us;
+  return jshell_usage_of_pid(job->pids[index], usage);
+}
+
+
+/**
+ * Get the usage of a job so far.
+ * @param job Job to account.
+ * @param usage Usage to fill in.
+ */
+void jshell_job_usage(const BackgroundJob* job, JShellUsage* usage) {
+  if (job->pid_count == 0) {
+    *usage = job->usage;
+  } else {
+    *usage = (JShellUsage){0};
+    for (size_t i = 0; i < job->pid_count; i++) {
+      JShellUsage pid_usage;
+      if (jshell_job_pid_usage(job, i, &pid_usage)) {
+        jshell_usage_add(usage, &pid_usage);
       }
     }
   }
 
-  job->status = JOB_DONE;
-  job->in_use = false;
-  return final_status;
+  uint64_t end = job->end_us != 0 ? job->end_us : jshell_usage_now();
+  usage->wall_us = end - job->start_us;
 }
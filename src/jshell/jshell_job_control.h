@@ -2,11 +2,17 @@
 #define JSHELL_JOB_CONTROL_H
 
 #include <sys/types.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
-#define MAX_JOBS 100
-#define MAX_PIDS_PER_JOB 50
-#define MAX_CMD_STRING 1024
+#include "jshell_sched.h"
+#include "jshell_spool.h"
+#include "jshell_usage.h"
+
+// Buckets of the pid -> job hash (power of two)
+#define JOB_PID_BUCKETS 1024
 
 
 typedef enum {
@@ -16,23 +22,63 @@ typedef enum {
 } JobStatus;
 
 
+// How jshell_wait_for_job_set() ended
+typedef enum {
+  JOB_WAIT_DONE,         // The selected job (or every job) finished
+  JOB_WAIT_TIMEOUT,
+  JOB_WAIT_INTERRUPTED,  // SIGINT
+  JOB_WAIT_ERROR
+} JobWaitResult;
+
+
 typedef struct {
   int job_id;
-  pid_t pids[MAX_PIDS_PER_JOB];
+  pid_t* pids;
+  int* pid_statuses;     // Exit status of each pid once it has been reaped
   size_t pid_count;
-  char cmd_string[MAX_CMD_STRING];
+  size_t pids_done;
+  char* cmd_string;
   JobStatus status;
-  bool in_use;
+  bool waited;           // Collected by `wait`; dropped without a notice
+  uint64_t start_us;     // jshell_usage_now() when the job was added
+  uint64_t end_us;       // When the job finished, or 0 while it runs
+  JShellUsage* pid_usage;  // Usage of each pid once it has been reaped
+  // Thread jobs (pid_count == 0) run inside the shell, e.g. `@query &`
+  int exit_code;         // Once a thread job has finished
+  char* output;          // Printed when a thread job is reported, or NULL
+  atomic_bool cancelled; // Set by `kill`; polled by the job's thread
+  JShellUsage usage;     // CPU time and peak memory of a finished thread
+  JShellSched sched;     // Placement given with `run`, if any
+  JShellSpool* spool;    // Output kept instead of printed, or NULL
 } BackgroundJob;
 
 
 void jshell_init_job_control(void);
 
-int jshell_add_background_job(pid_t* pids, size_t pid_count, 
-                               const char* cmd_string);
+int jshell_job_control_fd(void);
+
+// sched: placement the processes were started with, or NULL
+int jshell_add_background_job(pid_t* pids, size_t pid_count,
+                               const char* cmd_string,
+                               const JShellSched* sched);
+
+// Add a job that runs on a thread of the shell rather than as processes
+// Returns the job ID, or -1 on failure
+int jshell_add_thread_job(const char* cmd_string);
+
+// Keep a job's output in spool, which the job then owns; printed when
+// the job is reported or collected by `wait` (freed if there is no job)
+void jshell_job_set_spool(int job_id, JShellSpool* spool);
+
+// Report that a thread job finished; safe to call from any thread
+// Takes ownership of output (may be NULL), which is printed when the job
+// is reported done or collected by `wait`
+void jshell_finish_thread_job(int job_id, int exit_code, char* output);
 
 void jshell_update_job_status(pid_t pid, int status);
 
+size_t jshell_reap_background_jobs(void);
+
 void jshell_check_background_jobs(void);
 
 void jshell_print_jobs(void);
@@ -51,5 +97,26 @@ void jshell_for_each_job(void (*callback)(const BackgroundJob *job,
 
 int jshell_wait_for_job(int job_id);
 
+// Open a pidfd that becomes readable when pid exits (without reaping
+// it), or return -1 where pidfds are not supported
+int jshell_open_pidfd(pid_t pid);
+
+// Wait until one (any) or all of the given jobs finish, or timeout_ms
+// passes (negative: no timeout); processes are watched through pidfds
+// Collected jobs get their exit status in statuses, the rest -1
+JobWaitResult jshell_wait_for_job_set(const int* job_ids, size_t count,
+                                      bool any, int timeout_ms,
+                                      int* statuses);
+
+// Usage of a job so far: wall time since it was started, CPU time summed
+// over its processes and their largest peak memory; processes still
+// running are read from /proc
+void jshell_job_usage(const BackgroundJob* job, JShellUsage* usage);
+
+// Usage of the pid at index within a job, whether reaped or running
+// Returns false if a running pid cannot be read
+bool jshell_job_pid_usage(const BackgroundJob* job, size_t index,
+                          JShellUsage* usage);
+
 
 #endif
@@ -0,0 +1,549 @@
+/**
+ * @file jshell_line_editor.c
+ * @brief Interactive line editing with history and tab completion.
+ *
+ * The terminal is put in raw mode only while a line is being read, so
+ * commands always run with the terminal settings the shell started with.
+ * The line is redrawn on a single row, scrolling horizontally when it is
+ * wider than the terminal. Input is awaited through the event loop, so
+ * background jobs that finish at the prompt are reported right away.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "jshell_line_editor.h"
+#include "jshell_completion.h"
+#include "jshell_event_loop.h"
+#include "jshell_history.h"
+#include "jshell_job_control.h"
+#include "jshell_signals.h"
+#include "utils/jbox_utils.h"
+
+
+/** Most candidates printed when a second Tab lists them */
+#define LIST_MAX_ITEMS 100
+
+#define KEY_CTRL(c) ((c) & 0x1f)
+#define KEY_ESC 27
+#define KEY_BACKSPACE 127
+
+
+/** State of the line being edited */
+typedef struct {
+  char* buf;
+  size_t size;
+  size_t len;
+  size_t pos;
+  const char* prompt;
+  size_t prompt_len;
+  size_t history_index;       /* history count: the line being typed */
+  char* saved;                /* The typed line while browsing history */
+  bool last_was_tab;
+} LineState;
+
+
+/**
+ * Write a buffer to the terminal.
+ * @param data Bytes to write.
+ * @param len Number of bytes.
+ */
+static void term_write(const char* data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(STDOUT_FILENO, data, len);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    data += n;
+    len -= (size_t)n;
+  }
+}
+
+
+/**
+ * Width of the terminal, 80 if it cannot be determined.
+ */
+static size_t term_columns(void) {
+  struct winsize ws;
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) != 0 || ws.ws_col == 0) {
+    return 80;
+  }
+  return ws.ws_col;
+}
+
+
+/**
+ * Switch the terminal to raw input, keeping output processing so '\n'
+ * still starts a new line for job reports and listings.
+ * @param saved Receives the settings to restore.
+ * @return 0 on success, -1 on error.
+ */
+static int enable_raw_mode(struct termios* saved) {
+  if (tcgetattr(STDIN_FILENO, saved) != 0) {
+    return -1;
+  }
+
+  struct termios raw = *saved;
+  raw.c_iflag &= ~(ICRNL | IXON | BRKINT | INPCK | ISTRIP);
+  raw.c_cflag |= CS8;
+  raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+  raw.c_cc[VMIN] = 1;
+  raw.c_cc[VTIME] = 0;
+  return tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+}
+
+
+/**
+ * Redraw the prompt and the visible part of the line.
+ * @param ls Line state.
+ */
+static void refresh_line(LineState* ls) {
+  size_t columns = term_columns();
+  const char* text = ls->buf;
+  size_t len = ls->len;
+  size_t pos = ls->pos;
+
+  /* Scroll so the cursor stays on screen */
+  while (ls->prompt_len + pos >= columns && pos > 0) {
+    text++;
+    len--;
+    pos--;
+  }
+  while (ls->prompt_len + len > columns && len > pos) {
+    len--;
+  }
+
+  size_t cap = ls->prompt_len + len + 32;
+  char* out = malloc(cap);
+  if (out == NULL) {
+    return;
+  }
+  int n = snprintf(out, cap, "\r%s%.*s\x1b[0K\r", ls->prompt, (int)len,
+                   text);
+  size_t used = n > 0 ? (size_t)n : 0;
+  if (ls->prompt_len + pos > 0 && used < cap) {
+    n = snprintf(out + used, cap - used, "\x1b[%zuC", ls->prompt_len + pos);
+    used += n > 0 ? (size_t)n : 0;
+  }
+  term_write(out, used < cap ? used : cap - 1);
+  free(out);
+}
+
+
+/**
+ * Replace part of the line and move the cursor after the new text.
+ * @param ls Line state.
+ * @param start Start of the replaced range.
+ * @param end End of the replaced range.
+ * @param text Replacement.
+ * @param text_len Length of text.
+ * @return true if it fit in the buffer.
+ */
+static bool replace_range(LineState* ls, size_t start, size_t end,
+                          const char* text, size_t text_len) {
+  if (ls->len - (end - start) + text_len >= ls->size) {
+    return false;
+  }
+  memmove(ls->buf + start + text_len, ls->buf + end, ls->len - end + 1);
+  memcpy(ls->buf + start, text, text_len);
+  ls->len = ls->len - (end - start) + text_len;
+  ls->pos = start + text_len;
+  return true;
+}
+
+
+/**
+ * Replace the whole line.
+ * @param ls Line state.
+ * @param text New contents.
+ */
+static void set_line(LineState* ls, const char* text) {
+  size_t len = strlen(text);
+  if (len >= ls->size) {
+    len = ls->size - 1;
+  }
+  memcpy(ls->buf, text, len);
+  ls->buf[len] = '\0';
+  ls->len = len;
+  ls->pos = len;
+}
+
+
+/**
+ * Step through history.
+ * @param ls Line state.
+ * @param older true for the previous entry, false for the next one.
+ */
+static void history_step(LineState* ls, bool older) {
+  size_t count = jshell_history_count();
+  if (ls->history_index > count) {
+    ls->history_index = count;
+  }
+
+  if (older) {
+    if (ls->history_index == 0) {
+      return;
+    }
+    if (ls->history_index == count) {
+      free(ls->saved);
+      ls->saved = strdup(ls->buf);
+    }
+    ls->history_index--;
+  } else {
+    if (ls->history_index >= count) {
+      return;
+    }
+    ls->history_index++;
+  }
+
+  const char* text = ls->history_index == count
+                     ? ls->saved : jshell_history_get(ls->history_index);
+  set_line(ls, text != NULL ? text : "");
+  refresh_line(ls);
+}
+
+
+/**
+ * Print completion candidates in columns below the line.
+ * @param completions Candidates.
+ */
+static void list_candidates(const JShellCompletions* completions) {
+  size_t shown = completions->item_count < LIST_MAX_ITEMS
+                 ? completions->item_count : LIST_MAX_ITEMS;
+  size_t width = 0;
+  for (size_t i = 0; i < shown; i++) {
+    size_t len = strlen(completions->items[i]);
+    if (len > width) {
+      width = len;
+    }
+  }
+  width += 2;
+
+  size_t per_row = term_columns() / width;
+  if (per_row == 0) {
+    per_row = 1;
+  }
+  size_t rows = (shown + per_row - 1) / per_row;
+
+  printf("\n");
+  for (size_t row = 0; row < rows; row++) {
+    for (size_t col = 0; col < per_row; col++) {
+      size_t i = col * rows + row;
+      if (i < shown) {
+        printf("%-*s", (int)width, completions->items[i]);
+      }
+    }
+    printf("\n");
+  }
+  if (completions->count > shown) {
+    printf("... and %zu more\n", completions->count - shown);
+  }
+  fflush(stdout);
+}
+
+
+/**
+ * Complete the word before the cursor: a single match is inserted whole,
+ * several matches extend the word to their common prefix, and a second
+ * Tab with nothing left to insert lists them.
+ * @param ls Line state.
+ */
+static void complete_line(LineState* ls) {
+  size_t word_start;
+  JShellCompletions completions;
+
+  if (jshell_complete(ls->buf, ls->pos, &word_start, &completions) != 0
+      || completions.item_count == 0) {
+    term_write("\a", 1);
+    jshell_completions_free(&completions);
+    return;
+  }
+
+  size_t typed = ls->pos - word_start;
+  const char* first = completions.items[0];
+  if (completions.count == 1) {
+    size_t len = strlen(first);
+    replace_range(ls, word_start, ls->pos, first, len);
+    if (len > 0 && first[len - 1] != '/') {
+      replace_range(ls, ls->pos, ls->pos, " ", 1);
+    }
+  } else if (completions.common > typed) {
+    replace_range(ls, word_start, ls->pos, first, completions.common);
+  } else if (ls->last_was_tab) {
+    list_candidates(&completions);
+  } else {
+    term_write("\a", 1);
+  }
+
+  jshell_completions_free(&completions);
+  refresh_line(ls);
+  ls->last_was_tab = true;
+}
+
+
+/**
+ * Read one byte of input, reporting finished background jobs while
+ * waiting.
+ * @param ls Line state, redrawn after a report.
+ * @param c Receives the byte.
+ * @return 1 for a byte, 0 at end of input, -1 on error or termination.
+ */
+static int read_key(LineState* ls, unsigned char* c) {
+  while (true) {
+    JShellEvent event = jshell_event_wait_input(STDIN_FILENO);
+    if (event == JSHELL_EVENT_JOBS_DONE) {
+      term_write("\n", 1);
+      jshell_check_background_jobs();
+      fflush(stdout);
+      refresh_line(ls);
+      continue;
+    }
+    if (event == JSHELL_EVENT_INTERRUPTED) {
+      if (jshell_should_terminate() || jshell_should_hangup()) {
+        return -1;
+      }
+      continue;
+    }
+    if (event == JSHELL_EVENT_ERROR) {
+      return -1;
+    }
+
+    ssize_t n = read(STDIN_FILENO, c, 1);
+    if (n == 1) {
+      return 1;
+    }
+    if (n == 0) {
+      return 0;
+    }
+    if (errno != EINTR && errno != EAGAIN) {
+      return -1;
+    }
+  }
+}
+
+
+/**
+ * Handle the rest of an escape sequence (arrows, Home, End, Delete).
+ * @param ls Line state.
+ * @return false if input ended.
+ */
+static bool handle_escape(LineState* ls) {
+  unsigned char seq[3];
+  if (read_key(ls, &seq[0]) != 1 || read_key(ls, &seq[1]) != 1) {
+    return false;
+  }
+
+  char key = 0;
+  if (seq[0] == '[' && seq[1] >= '0' && seq[1] <= '9') {
+    if (read_key(ls, &seq[2]) != 1) {
+      return false;
+    }
+    if (seq[2] == '~') {
+      key = seq[1] == '3' ? 'X'
+            : (seq[1] == '1' || seq[1] == '7') ? 'H'
+            : (seq[1] == '4' || seq[1] == '8') ? 'F' : 0;
+    }
+  } else if (seq[0] == '[' || seq[0] == 'O') {
+    key = (char)seq[1];
+  }
+
+  switch (key) {
+    case 'A':
+      history_step(ls, true);
+      break;
+    case 'B':
+      history_step(ls, false);
+      break;
+    case 'C':
+      if (ls->pos < ls->len) {
+        ls->pos++;
+        refresh_line(ls);
+      }
+      break;
+    case 'D':
+      if (ls->pos > 0) {
+        ls->pos--;
+        refresh_line(ls);
+      }
+      break;
+    case 'H':
+      ls->pos = 0;
+      refresh_line(ls);
+      break;
+    case 'F':
+      ls->pos = ls->len;
+      refresh_line(ls);
+      break;
+    case 'X':
+      if (ls->pos < ls->len) {
+        replace_range(ls, ls->pos, ls->pos + 1, "", 0);
+        refresh_line(ls);
+      }
+      break;
+    default:
+      break;
+  }
+  return true;
+}
+
+
+/**
+ * Edit a line until Enter, Ctrl-C or end of input.
+ * @param ls Line state.
+ * @return How editing ended.
+ */
+static JShellLineResult edit_line(LineState* ls) {
+  refresh_line(ls);
+
+  while (true) {
+    unsigned char c;
+    int got = read_key(ls, &c);
+    if (got == 0) {
+      return JSHELL_LINE_EOF;
+    }
+    if (got < 0) {
+      return JSHELL_LINE_INTERRUPTED;
+    }
+
+    if (c != '\t') {
+      ls->last_was_tab = false;
+    }
+
+    switch (c) {
+      case '\r':
+      case '\n':
+        ls->pos = ls->len;
+        refresh_line(ls);
+        term_write("\n", 1);
+        return JSHELL_LINE_OK;
+      case KEY_CTRL('C'):
+        term_write("^C\n", 3);
+        return JSHELL_LINE_INTERRUPTED;
+      case KEY_CTRL('D'):
+        if (ls->len == 0) {
+          term_write("\n", 1);
+          return JSHELL_LINE_EOF;
+        }
+        if (ls->pos < ls->len) {
+          replace_range(ls, ls->pos, ls->pos + 1, "", 0);
+          refresh_line(ls);
+        }
+        break;
+      case '\t':
+        complete_line(ls);
+        break;
+      case KEY_BACKSPACE:
+      case KEY_CTRL('H'):
+        if (ls->pos > 0) {
+          replace_range(ls, ls->pos - 1, ls->pos, "", 0);
+          refresh_line(ls);
+        }
+        break;
+      case KEY_CTRL('A'):
+        ls->pos = 0;
+        refresh_line(ls);
+        break;
+      case KEY_CTRL('E'):
+        ls->pos = ls->len;
+        refresh_line(ls);
+        break;
+      case KEY_CTRL('B'):
+        if (ls->pos > 0) {
+          ls->pos--;
+          refresh_line(ls);
+        }
+        break;
+      case KEY_CTRL('F'):
+        if (ls->pos < ls->len) {
+          ls->pos++;
+          refresh_line(ls);
+        }
+        break;
+      case KEY_CTRL('P'):
+        history_step(ls, true);
+        break;
+      case KEY_CTRL('N'):
+        history_step(ls, false);
+        break;
+      case KEY_CTRL('U'):
+        replace_range(ls, 0, ls->pos, "", 0);
+        refresh_line(ls);
+        break;
+      case KEY_CTRL('K'):
+        ls->buf[ls->pos] = '\0';
+        ls->len = ls->pos;
+        refresh_line(ls);
+        break;
+      case KEY_CTRL('W'): {
+        size_t start = ls->pos;
+        while (start > 0 && ls->buf[start - 1] == ' ') {
+          start--;
+        }
+        while (start > 0 && ls->buf[start - 1] != ' ') {
+          start--;
+        }
+        replace_range(ls, start, ls->pos, "", 0);
+        refresh_line(ls);
+        break;
+      }
+      case KEY_CTRL('L'):
+        term_write("\x1b[H\x1b[2J", 7);
+        refresh_line(ls);
+        break;
+      case KEY_ESC:
+        if (!handle_escape(ls)) {
+          return JSHELL_LINE_EOF;
+        }
+        break;
+      default:
+        if (c >= ' ' && replace_range(ls, ls->pos, ls->pos, (char*)&c, 1)) {
+          refresh_line(ls);
+        }
+        break;
+    }
+  }
+}
+
+
+/**
+ * Read a line from the terminal with editing, history and completion.
+ * @param prompt Prompt to show.
+ * @param buf Buffer for the line.
+ * @param size Size of buf.
+ * @return How reading ended.
+ */
+JShellLineResult jshell_line_read(const char* prompt, char* buf,
+                                  size_t size) {
+  struct termios saved;
+
+  if (size == 0 || enable_raw_mode(&saved) != 0) {
+    return JSHELL_LINE_ERROR;
+  }
+  fflush(stdout);
+
+  LineState ls = {
+    .buf = buf,
+    .size = size,
+    .prompt = prompt,
+    .prompt_len = strlen(prompt),
+    .history_index = jshell_history_count(),
+  };
+  buf[0] = '\0';
+
+  JShellLineResult result = edit_line(&ls);
+
+  tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+  free(ls.saved);
+  DPRINT("Line editor: result %d, %zu bytes", (int)result, ls.len);
+  return result;
+}
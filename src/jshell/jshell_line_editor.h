@@ -0,0 +1,23 @@
+#ifndef JSHELL_LINE_EDITOR_H
+#define JSHELL_LINE_EDITOR_H
+
+#include <stddef.h>
+
+
+// How jshell_line_read() ended
+typedef enum {
+  JSHELL_LINE_OK,            // A line was entered
+  JSHELL_LINE_EOF,           // Ctrl-D on an empty line, or input closed
+  JSHELL_LINE_INTERRUPTED,   // Ctrl-C, or a termination signal
+  JSHELL_LINE_ERROR          // The terminal cannot be put in raw mode
+} JShellLineResult;
+
+
+// Read a line from the terminal with editing, history and tab completion
+// Prompts with prompt and stores the NUL-terminated line (without the
+// newline) in buf; background jobs finishing meanwhile are reported
+// above the line; stdin and stdout must be terminals
+JShellLineResult jshell_line_read(const char* prompt, char* buf, size_t size);
+
+
+#endif
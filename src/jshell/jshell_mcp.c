@@ -0,0 +1,1061 @@
+/**
+ * @file jshell_mcp.c
+ * @brief Model Context Protocol tool server on standard input/output.
+ *
+ * `jshell --mcp` reads JSON-RPC 2.0 messages, one per line, from stdin and
+ * answers on stdout, as MCP's stdio transport has it. Every registered
+ * command with a run entry point is offered as a tool. Its input schema
+ * is generated from the command's argtable3 table: options become
+ * properties named after their long (or short) option, positionals after
+ * their datatype, with the type taken from the argtable entry and arrays
+ * for entries that may repeat.
+ *
+ * A tools/call turns the arguments object straight into argv and calls
+ * the command through jshell_run_builtin(), so a structured call is never
+ * parsed, expanded or forked. Commands with a --json option get it unless
+ * the call sets "json" to false, and output that is a JSON object is also
+ * returned as structuredContent. As in the socket server, fds 1 and 2
+ * point at memory files while a command runs; the protocol itself uses
+ * private copies of the original stdin and stdout, and stray writes to
+ * fd 1 between calls go to stderr, so nothing corrupts the message stream.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "argtable3.h"
+
+#include "jshell_mcp.h"
+#include "jshell_cmd_registry.h"
+#include "jshell_thread_exec.h"
+#include "utils/jbox_json.h"
+
+
+/** MCP revision answered when the client does not name one */
+#define MCP_PROTOCOL_VERSION "2025-06-18"
+
+/** JSON-RPC error codes */
+#define RPC_PARSE_ERROR      -32700
+#define RPC_INVALID_REQUEST  -32600
+#define RPC_METHOD_NOT_FOUND -32601
+#define RPC_INVALID_PARAMS   -32602
+
+/** Longest property name derived from an argtable entry */
+#define MCP_NAME_MAX 64
+
+/** Most entries of one argtable */
+#define MCP_MAX_ARGS 64
+
+
+/** How an argtable entry's values are written in the schema and argv */
+typedef enum {
+  MCP_ARG_FLAG,     // arg_lit: boolean, or a count if it may repeat
+  MCP_ARG_INT,
+  MCP_ARG_NUMBER,
+  MCP_ARG_STRING    // arg_str, arg_file, arg_rex and anything else
+} McpArgKind;
+
+
+/** One argtable entry as a tool property */
+typedef struct {
+  const struct arg_hdr *hdr;
+  McpArgKind kind;
+  bool positional;
+  char name[MCP_NAME_MAX];
+} McpArg;
+
+
+/** A growable argument vector */
+typedef struct {
+  char **v;
+  int n;
+  int cap;
+} McpStrv;
+
+
+/** One parsed request line; the spans point into the line */
+typedef struct {
+  char *id;            // Raw number or decoded string, or NULL
+  bool id_is_string;
+  char *method;
+  const char *params;
+  size_t params_len;
+} McpRequest;
+
+
+/** A tools/call argv being built from the arguments object */
+typedef struct {
+  const char *name;
+  const char *arguments;   // Raw JSON object, or NULL
+  size_t arguments_len;
+  McpStrv argv;
+  const char *error;       // Why the arguments do not fit, or NULL
+  char error_buf[160];
+} McpCall;
+
+
+/** Scan functions of the argtable types told apart in schemas */
+static arg_scanfn *lit_scanfn;
+static arg_scanfn *int_scanfn;
+static arg_scanfn *dbl_scanfn;
+
+
+/**
+ * Learn the scan functions of arg_lit, arg_int and arg_dbl from a probe
+ * of each, since argtable3 keeps them private.
+ */
+static void init_arg_kinds(void) {
+  void *probes[] = {
+    arg_lit0(NULL, NULL, NULL),
+    arg_int0(NULL, NULL, NULL, NULL),
+    arg_dbl0(NULL, NULL, NULL, NULL),
+  };
+  if (probes[0] != NULL && probes[1] != NULL && probes[2] != NULL) {
+    lit_scanfn = ((struct arg_hdr *)probes[0])->scanfn;
+    int_scanfn = ((struct arg_hdr *)probes[1])->scanfn;
+    dbl_scanfn = ((struct arg_hdr *)probes[2])->scanfn;
+  }
+  arg_freetable(probes, sizeof(probes) / sizeof(probes[0]));
+}
+
+
+/**
+ * Derive a property name: the first long option, the short option, or
+ * for a positional its datatype ("FILE..." becomes "file").
+ * @param hdr Argtable entry.
+ * @param name Receives the name.
+ */
+static void arg_property_name(const struct arg_hdr *hdr,
+                              char name[MCP_NAME_MAX]) {
+  size_t len = 0;
+  if (hdr->longopts != NULL && hdr->longopts[0] != '\0') {
+    len = strcspn(hdr->longopts, ",");
+    if (len >= MCP_NAME_MAX) {
+      len = MCP_NAME_MAX - 1;
+    }
+    memcpy(name, hdr->longopts, len);
+  } else if (hdr->shortopts != NULL && hdr->shortopts[0] != '\0') {
+    name[len++] = hdr->shortopts[0];
+  } else if (hdr->datatype != NULL) {
+    for (const char *p = hdr->datatype; *p && len < MCP_NAME_MAX - 1; p++) {
+      if (isalnum((unsigned char)*p) || *p == '_' || *p == '-') {
+        name[len++] = (char)tolower((unsigned char)*p);
+      } else if (len > 0) {
+        break;  // "FILE..." or "<file>|-"
+      }
+    }
+  }
+  if (len == 0) {
+    strcpy(name, "args");
+    return;
+  }
+  name[len] = '\0';
+}
+
+
+/**
+ * List the entries of an argtable that become tool properties: all but
+ * the terminating arg_end and --help.
+ * @param argtable Table ended by its arg_end.
+ * @param args Receives the entries.
+ * @return Number of entries.
+ */
+static int collect_args(void **argtable, McpArg args[MCP_MAX_ARGS]) {
+  int count = 0;
+  for (int i = 0; count < MCP_MAX_ARGS; i++) {
+    const struct arg_hdr *hdr = argtable[i];
+    if (hdr->flag & ARG_TERMINATOR) {
+      break;
+    }
+    McpArg *arg = &args[count];
+    arg->hdr = hdr;
+    arg->positional = hdr->shortopts == NULL && hdr->longopts == NULL;
+    arg->kind = hdr->scanfn == lit_scanfn ? MCP_ARG_FLAG
+              : hdr->scanfn == int_scanfn ? MCP_ARG_INT
+              : hdr->scanfn == dbl_scanfn ? MCP_ARG_NUMBER
+              : MCP_ARG_STRING;
+    arg_property_name(hdr, arg->name);
+    if (arg->kind == MCP_ARG_FLAG && strcmp(arg->name, "help") == 0) {
+      continue;
+    }
+    count++;
+  }
+  return count;
+}
+
+
+/**
+ * Tell whether a command's table has a --json flag the server sets.
+ * @param args Entries of the table.
+ * @param count Number of entries.
+ * @return The entry, or NULL.
+ */
+static const McpArg *find_json_flag(const McpArg *args, int count) {
+  for (int i = 0; i < count; i++) {
+    if (args[i].kind == MCP_ARG_FLAG && strcmp(args[i].name, "json") == 0) {
+      return &args[i];
+    }
+  }
+  return NULL;
+}
+
+
+// ---------------------------------------------------------------------------
+// Schemas
+// ---------------------------------------------------------------------------
+
+/**
+ * Write the JSON schema type of one value of an entry.
+ * @param w Writer, inside the property's object.
+ * @param kind Kind of the entry.
+ */
+static void write_value_type(jbox_json_writer_t *w, McpArgKind kind) {
+  jbox_json_key(w, "type");
+  jbox_json_string(w, kind == MCP_ARG_FLAG ? "boolean"
+                      : kind == MCP_ARG_INT ? "integer"
+                      : kind == MCP_ARG_NUMBER ? "number"
+                      : "string");
+}
+
+
+/**
+ * Argtable visitor writing a tool's inputSchema.
+ * @param argtable The command's table.
+ * @param userdata jbox_json_writer_t.
+ */
+static void write_input_schema(void **argtable, void *userdata) {
+  jbox_json_writer_t *w = userdata;
+  McpArg args[MCP_MAX_ARGS];
+  int count = collect_args(argtable, args);
+  const McpArg *json_flag = find_json_flag(args, count);
+
+  jbox_json_begin_object(w);
+  jbox_json_key(w, "type");
+  jbox_json_string(w, "object");
+  jbox_json_key(w, "properties");
+  jbox_json_begin_object(w);
+  for (int i = 0; i < count; i++) {
+    const McpArg *arg = &args[i];
+    const struct arg_hdr *hdr = arg->hdr;
+    jbox_json_key(w, arg->name);
+    jbox_json_begin_object(w);
+    if (arg->kind == MCP_ARG_FLAG && hdr->maxcount > 1) {
+      jbox_json_key(w, "type");
+      jbox_json_string(w, "integer");
+      jbox_json_key(w, "minimum");
+      jbox_json_int(w, 0);
+      jbox_json_key(w, "maximum");
+      jbox_json_int(w, hdr->maxcount);
+    } else if (arg->kind != MCP_ARG_FLAG && hdr->maxcount > 1) {
+      jbox_json_key(w, "type");
+      jbox_json_string(w, "array");
+      jbox_json_key(w, "items");
+      jbox_json_begin_object(w);
+      write_value_type(w, arg->kind);
+      jbox_json_end_object(w);
+      if (hdr->mincount > 0) {
+        jbox_json_key(w, "minItems");
+        jbox_json_int(w, hdr->mincount);
+      }
+      jbox_json_key(w, "maxItems");
+      jbox_json_int(w, hdr->maxcount);
+    } else {
+      write_value_type(w, arg->kind);
+    }
+    if (arg == json_flag) {
+      jbox_json_key(w, "default");
+      jbox_json_bool(w, true);
+    }
+    if (hdr->glossary != NULL) {
+      jbox_json_key(w, "description");
+      jbox_json_string(w, hdr->glossary);
+    }
+    jbox_json_end_object(w);
+  }
+  jbox_json_end_object(w);
+
+  jbox_json_key(w, "required");
+  jbox_json_begin_array(w);
+  for (int i = 0; i < count; i++) {
+    if (args[i].hdr->mincount > 0) {
+      jbox_json_string(w, args[i].name);
+    }
+  }
+  jbox_json_end_array(w);
+  jbox_json_end_object(w);
+}
+
+
+/**
+ * Tell whether a command can be called as a tool.
+ * @param spec Command specification.
+ * @return true if it has a run entry point and an argtable.
+ */
+static bool is_tool(const jshell_cmd_spec_t *spec) {
+  return spec != NULL && spec->run != NULL && spec->describe_args != NULL;
+}
+
+
+/**
+ * Registry visitor writing one tool of a tools/list result.
+ * @param spec Command specification.
+ * @param userdata jbox_json_writer_t, inside the tools array.
+ */
+static void write_tool(const jshell_cmd_spec_t *spec, void *userdata) {
+  jbox_json_writer_t *w = userdata;
+  if (!is_tool(spec)) {
+    return;
+  }
+
+  jbox_json_begin_object(w);
+  jbox_json_key(w, "name");
+  jbox_json_string(w, spec->name);
+  jbox_json_key(w, "description");
+  if (spec->long_help != NULL) {
+    size_t len = strlen(spec->summary) + strlen(spec->long_help) + 3;
+    char *description = malloc(len);
+    if (description != NULL) {
+      snprintf(description, len, "%s. %s", spec->summary, spec->long_help);
+    }
+    jbox_json_string(w, description != NULL ? description : spec->summary);
+    free(description);
+  } else {
+    jbox_json_string(w, spec->summary);
+  }
+  jbox_json_key(w, "inputSchema");
+  spec->describe_args(write_input_schema, w);
+  jbox_json_end_object(w);
+}
+
+
+// ---------------------------------------------------------------------------
+// Calls
+// ---------------------------------------------------------------------------
+
+/**
+ * Append a copy of a string to a vector.
+ * @param strv Vector.
+ * @param str String to copy.
+ * @return 0 on success, -1 if memory ran out.
+ */
+static int strv_push(McpStrv *strv, const char *str) {
+  if (strv->n + 2 > strv->cap) {
+    int new_cap = strv->cap ? strv->cap * 2 : 16;
+    char **grown = realloc(strv->v, (size_t)new_cap * sizeof(char *));
+    if (grown == NULL) {
+      return -1;
+    }
+    strv->v = grown;
+    strv->cap = new_cap;
+  }
+  strv->v[strv->n] = strdup(str);
+  if (strv->v[strv->n] == NULL) {
+    return -1;
+  }
+  strv->v[++strv->n] = NULL;
+  return 0;
+}
+
+
+/**
+ * Free a vector and its strings.
+ * @param strv Vector.
+ */
+static void strv_free(McpStrv *strv) {
+  for (int i = 0; i < strv->n; i++) {
+    free(strv->v[i]);
+  }
+  free(strv->v);
+  memset(strv, 0, sizeof(*strv));
+}
+
+
+/**
+ * Record why the arguments do not fit the command.
+ * @param call Call being built.
+ * @param fmt printf format.
+ */
+static void call_fail(McpCall *call, const char *fmt, ...)
+  __attribute__((format(printf, 2, 3)));
+
+static void call_fail(McpCall *call, const char *fmt, ...) {
+  if (call->error != NULL) {
+    return;
+  }
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(call->error_buf, sizeof(call->error_buf), fmt, ap);
+  va_end(ap);
+  call->error = call->error_buf;
+}
+
+
+/**
+ * Append one option occurrence: "--name=value", "--name", "-x value"
+ * or "-x".
+ * @param argv Vector.
+ * @param hdr Option entry.
+ * @param value Value, or NULL for a flag.
+ * @return 0 on success, -1 if memory ran out.
+ */
+static int push_option(McpStrv *argv, const struct arg_hdr *hdr,
+                       const char *value) {
+  char buf[MCP_NAME_MAX + 3];
+  if (hdr->longopts != NULL && hdr->longopts[0] != '\0') {
+    int len = (int)strcspn(hdr->longopts, ",");
+    if (value == NULL) {
+      snprintf(buf, sizeof(buf), "--%.*s", len, hdr->longopts);
+      return strv_push(argv, buf);
+    }
+    size_t size = (size_t)len + strlen(value) + 4;
+    char *opt = malloc(size);
+    if (opt == NULL) {
+      return -1;
+    }
+    snprintf(opt, size, "--%.*s=%s", len, hdr->longopts, value);
+    int rc = strv_push(argv, opt);
+    free(opt);
+    return rc;
+  }
+  snprintf(buf, sizeof(buf), "-%c", hdr->shortopts[0]);
+  if (strv_push(argv, buf) != 0) {
+    return -1;
+  }
+  return value != NULL ? strv_push(argv, value) : 0;
+}
+
+
+/**
+ * Read the values of one argument and append them to the option argv or
+ * to the entry's positional values.
+ * @param call Call being built.
+ * @param r Reader positioned before the value.
+ * @param arg Entry the argument names.
+ * @param options Receives option occurrences.
+ * @param values Receives positional values of the entry.
+ */
+static void read_argument(McpCall *call, jbox_json_reader_t *r,
+                          const McpArg *arg, McpStrv *options,
+                          McpStrv *values) {
+  const struct arg_hdr *hdr = arg->hdr;
+  jbox_json_event_t ev = jbox_json_next(r);
+
+  if (arg->kind == MCP_ARG_FLAG) {
+    long long times = 0;
+    if (ev == JBOX_JSON_TRUE) {
+      times = 1;
+    } else if (ev == JBOX_JSON_NUMBER) {
+      times = strtoll(r->text, NULL, 10);
+    } else if (ev != JBOX_JSON_FALSE) {
+      call_fail(call, "%s: expected a boolean", arg->name);
+      jbox_json_skip(r, ev);
+      return;
+    }
+    if (times < 0 || times > hdr->maxcount) {
+      call_fail(call, "%s: at most %d", arg->name, hdr->maxcount);
+      return;
+    }
+    for (long long i = 0; i < times; i++) {
+      if (push_option(options, hdr, NULL) != 0) {
+        call_fail(call, "out of memory");
+      }
+    }
+    return;
+  }
+
+  bool many = ev == JBOX_JSON_ARRAY_BEGIN;
+  if (many && hdr->maxcount <= 1) {
+    call_fail(call, "%s: expected a single value", arg->name);
+    jbox_json_skip(r, ev);
+    return;
+  }
+  if (many) {
+    ev = jbox_json_next(r);
+  }
+  while (!many || ev != JBOX_JSON_ARRAY_END) {
+    bool ok = ev == JBOX_JSON_STRING
+              ? arg->kind == MCP_ARG_STRING
+              : ev == JBOX_JSON_NUMBER && arg->kind != MCP_ARG_STRING;
+    if (!ok) {
+      call_fail(call, "%s: expected %s", arg->name,
+                arg->kind == MCP_ARG_STRING ? "a string" : "a number");
+      if (ev == JBOX_JSON_ERROR) {
+        return;
+      }
+      jbox_json_skip(r, ev);
+    } else if (arg->positional ? strv_push(values, r->text)
+                               : push_option(options, hdr, r->text)) {
+      call_fail(call, "out of memory");
+    }
+    if (!many) {
+      break;
+    }
+    ev = jbox_json_next(r);
+  }
+}
+
+
+/**
+ * Argtable visitor building a call's argv from its arguments object.
+ * Options come first in the order given, then the positionals in table
+ * order, after "--" if one of them starts with '-'.
+ * @param argtable The command's table.
+ * @param userdata McpCall.
+ */
+static void build_call_argv(void **argtable, void *userdata) {
+  McpCall *call = userdata;
+  McpArg args[MCP_MAX_ARGS];
+  int count = collect_args(argtable, args);
+  McpStrv values[MCP_MAX_ARGS] = {0};
+  McpStrv options = {0};
+  bool json_given = false;
+
+  if (call->arguments != NULL) {
+    jbox_json_reader_t r;
+    jbox_json_reader_init(&r, call->arguments, call->arguments_len);
+    jbox_json_event_t ev = jbox_json_next(&r);
+    bool object = ev == JBOX_JSON_OBJECT_BEGIN;
+    if (!object && ev != JBOX_JSON_NULL) {
+      call_fail(call, "arguments must be an object");
+    }
+    while (object && call->error == NULL
+           && (ev = jbox_json_next(&r)) == JBOX_JSON_KEY) {
+      int i = 0;
+      while (i < count && strcmp(args[i].name, r.text) != 0) {
+        i++;
+      }
+      if (i == count) {
+        call_fail(call, "unknown argument: %s", r.text);
+        break;
+      }
+      json_given |= strcmp(args[i].name, "json") == 0
+                    && args[i].kind == MCP_ARG_FLAG;
+      read_argument(call, &r, &args[i], &options, &values[i]);
+    }
+    if (ev == JBOX_JSON_ERROR) {
+      call_fail(call, "malformed arguments");
+    }
+    jbox_json_reader_free(&r);
+  }
+
+  const McpArg *json_flag = find_json_flag(args, count);
+  if (json_flag != NULL && !json_given
+      && push_option(&options, json_flag->hdr, NULL) != 0) {
+    call_fail(call, "out of memory");
+  }
+
+  bool dashed = false;
+  for (int i = 0; i < count; i++) {
+    for (int j = 0; j < values[i].n; j++) {
+      dashed |= values[i].v[j][0] == '-';
+    }
+  }
+
+  if (call->error == NULL && strv_push(&call->argv, call->name) != 0) {
+    call_fail(call, "out of memory");
+  }
+  for (int i = 0; i < options.n && call->error == NULL; i++) {
+    if (strv_push(&call->argv, options.v[i]) != 0) {
+      call_fail(call, "out of memory");
+    }
+  }
+  if (dashed && call->error == NULL && strv_push(&call->argv, "--") != 0) {
+    call_fail(call, "out of memory");
+  }
+  for (int i = 0; i < count; i++) {
+    for (int j = 0; j < values[i].n && call->error == NULL; j++) {
+      if (strv_push(&call->argv, values[i].v[j]) != 0) {
+        call_fail(call, "out of memory");
+      }
+    }
+    strv_free(&values[i]);
+  }
+  strv_free(&options);
+}
+
+
+/**
+ * Read back everything written to a capture file.
+ * @param fd Capture descriptor.
+ * @param len Set to the number of bytes read.
+ * @return Allocated, NUL-terminated contents, or NULL on error.
+ */
+static char *read_capture(int fd, size_t *len) {
+  off_t size = lseek(fd, 0, SEEK_END);
+  char *data = size >= 0 ? malloc((size_t)size + 1) : NULL;
+  if (data == NULL) {
+    *len = 0;
+    return NULL;
+  }
+
+  size_t done = 0;
+  while (done < (size_t)size) {
+    ssize_t n = pread(fd, data + done, (size_t)size - done, (off_t)done);
+    if (n <= 0) {
+      if (n == -1 && errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    done += (size_t)n;
+  }
+
+  data[done] = '\0';
+  *len = done;
+  return data;
+}
+
+
+/**
+ * Turn output that is a single JSON object into one line, for
+ * structuredContent. Line breaks in valid JSON can only be whitespace
+ * between tokens, so they become spaces.
+ * @param text Output of a command, NUL-terminated; changed in place.
+ * @param len Its length.
+ * @return true if it is one well-formed object.
+ */
+static bool flatten_json_object(char *text, size_t len) {
+  while (len > 0 && isspace((unsigned char)text[len - 1])) {
+    len--;
+  }
+  jbox_json_reader_t r;
+  jbox_json_reader_init(&r, text, len);
+  jbox_json_event_t ev = jbox_json_next(&r);
+  bool object = ev == JBOX_JSON_OBJECT_BEGIN
+                && jbox_json_skip(&r, ev) == 0
+                && jbox_json_next(&r) == JBOX_JSON_DONE;
+  jbox_json_reader_free(&r);
+  if (!object) {
+    return false;
+  }
+
+  text[len] = '\0';
+  for (char *p = text; (p = strpbrk(p, "\r\n")) != NULL; p++) {
+    *p = ' ';
+  }
+  return true;
+}
+
+
+// ---------------------------------------------------------------------------
+// Messages
+// ---------------------------------------------------------------------------
+
+/**
+ * Start a response, echoing the request id (null if it had none).
+ * @param w Writer over the protocol stream.
+ * @param req Request being answered.
+ */
+static void begin_response(jbox_json_writer_t *w, const McpRequest *req) {
+  jbox_json_begin_object(w);
+  jbox_json_key(w, "jsonrpc");
+  jbox_json_string(w, "2.0");
+  jbox_json_key(w, "id");
+  if (req->id == NULL) {
+    jbox_json_null(w);
+  } else if (req->id_is_string) {
+    jbox_json_string(w, req->id);
+  } else {
+    jbox_json_raw(w, req->id);
+  }
+}
+
+
+/**
+ * End a response and send it.
+ * @param w Writer over the protocol stream.
+ */
+static void end_response(jbox_json_writer_t *w) {
+  jbox_json_end_object(w);
+  fputc('\n', w->out);
+  fflush(w->out);
+}
+
+
+/**
+ * Send a JSON-RPC error.
+ * @param out Protocol stream.
+ * @param req Request being answered.
+ * @param code JSON-RPC error code.
+ * @param message What went wrong.
+ */
+static void send_error(FILE *out, const McpRequest *req, int code,
+                       const char *message) {
+  jbox_json_writer_t w;
+  jbox_json_writer_init(&w, out, false);
+  begin_response(&w, req);
+  jbox_json_key(&w, "error");
+  jbox_json_begin_object(&w);
+  jbox_json_key(&w, "code");
+  jbox_json_int(&w, code);
+  jbox_json_key(&w, "message");
+  jbox_json_string(&w, message);
+  jbox_json_end_object(&w);
+  end_response(&w);
+}
+
+
+/**
+ * Answer initialize, agreeing to the client's protocol revision.
+ * @param out Protocol stream.
+ * @param req Request.
+ */
+static void handle_initialize(FILE *out, const McpRequest *req) {
+  char *version = NULL;
+  if (req->params != NULL) {
+    jbox_json_reader_t r;
+    jbox_json_reader_init(&r, req->params, req->params_len);
+    if (jbox_json_next(&r) == JBOX_JSON_OBJECT_BEGIN
+        && jbox_json_find_key(&r, "protocolVersion")) {
+      version = jbox_json_read_string(&r);
+    }
+    jbox_json_reader_free(&r);
+  }
+
+  jbox_json_writer_t w;
+  jbox_json_writer_init(&w, out, false);
+  begin_response(&w, req);
+  jbox_json_key(&w, "result");
+  jbox_json_begin_object(&w);
+  jbox_json_key(&w, "protocolVersion");
+  jbox_json_string(&w, version != NULL ? version : MCP_PROTOCOL_VERSION);
+  jbox_json_key(&w, "capabilities");
+  jbox_json_begin_object(&w);
+  jbox_json_key(&w, "tools");
+  jbox_json_begin_object(&w);
+  jbox_json_end_object(&w);
+  jbox_json_end_object(&w);
+  jbox_json_key(&w, "serverInfo");
+  jbox_json_begin_object(&w);
+  jbox_json_key(&w, "name");
+  jbox_json_string(&w, "jshell");
+  jbox_json_key(&w, "version");
+  jbox_json_string(&w, "1.0");
+  jbox_json_end_object(&w);
+  jbox_json_end_object(&w);
+  end_response(&w);
+  free(version);
+}
+
+
+/**
+ * Answer tools/list with every command that can be called.
+ * @param out Protocol stream.
+ * @param req Request.
+ */
+static void handle_tools_list(FILE *out, const McpRequest *req) {
+  jbox_json_writer_t w;
+  jbox_json_writer_init(&w, out, false);
+  begin_response(&w, req);
+  jbox_json_key(&w, "result");
+  jbox_json_begin_object(&w);
+  jbox_json_key(&w, "tools");
+  jbox_json_begin_array(&w);
+  jshell_for_each_command(write_tool, &w);
+  jbox_json_end_array(&w);
+  jbox_json_end_object(&w);
+  end_response(&w);
+}
+
+
+/**
+ * Run a command's argv with stdout and stderr captured in memory files.
+ * @param spec Command specification.
+ * @param argv Argument vector.
+ * @param out_data Set to the captured stdout.
+ * @param out_len Its length.
+ * @param err_data Set to the captured stderr.
+ * @param err_len Its length.
+ * @return Exit status, or -1 if the capture could not be set up.
+ */
+static int run_captured(const jshell_cmd_spec_t *spec, McpStrv *argv,
+                        char **out_data, size_t *out_len,
+                        char **err_data, size_t *err_len) {
+  int out_fd = memfd_create("jshell-stdout", MFD_CLOEXEC);
+  int err_fd = memfd_create("jshell-stderr", MFD_CLOEXEC);
+  int saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+  int saved_err = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 3);
+  int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  int status = -1;
+
+  if (out_fd >= 0 && err_fd >= 0 && saved_out >= 0 && saved_err >= 0
+      && null_fd >= 0) {
+    fflush(stdout);
+    fflush(stderr);
+    dup2(out_fd, STDOUT_FILENO);
+    dup2(err_fd, STDERR_FILENO);
+
+    status = jshell_run_builtin(spec, argv->n, argv->v, null_fd, -1);
+    null_fd = -1;  // Closed by jshell_run_builtin
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(saved_out, STDOUT_FILENO);
+    dup2(saved_err, STDERR_FILENO);
+
+    *out_data = read_capture(out_fd, out_len);
+    *err_data = read_capture(err_fd, err_len);
+  }
+
+  int fds[] = { out_fd, err_fd, saved_out, saved_err, null_fd };
+  for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+    if (fds[i] >= 0) {
+      close(fds[i]);
+    }
+  }
+  return status;
+}
+
+
+/**
+ * Write one text content item.
+ * @param w Writer inside the content array.
+ * @param text Text.
+ * @param len Its length.
+ */
+static void write_text_content(jbox_json_writer_t *w, const char *text,
+                               size_t len) {
+  jbox_json_begin_object(w);
+  jbox_json_key(w, "type");
+  jbox_json_string(w, "text");
+  jbox_json_key(w, "text");
+  jbox_json_string_n(w, text, len);
+  jbox_json_end_object(w);
+}
+
+
+/**
+ * Answer tools/call: build argv from the arguments, run the command and
+ * return its output.
+ * @param out Protocol stream.
+ * @param req Request.
+ */
+static void handle_tools_call(FILE *out, const McpRequest *req) {
+  McpCall call = {0};
+  char *name = NULL;
+
+  if (req->params != NULL) {
+    jbox_json_reader_t r;
+    jbox_json_reader_init(&r, req->params, req->params_len);
+    bool object = jbox_json_next(&r) == JBOX_JSON_OBJECT_BEGIN;
+    while (object && jbox_json_next(&r) == JBOX_JSON_KEY) {
+      if (strcmp(r.text, "name") == 0 && name == NULL) {
+        name = jbox_json_read_string(&r);
+      } else if (strcmp(r.text, "arguments") == 0) {
+        const char *start = r.pos;
+        if (jbox_json_skip(&r, jbox_json_next(&r)) == 0) {
+          call.arguments = start;
+          call.arguments_len = (size_t)(r.pos - start);
+        }
+      } else {
+        jbox_json_skip(&r, jbox_json_next(&r));
+      }
+    }
+    jbox_json_reader_free(&r);
+  }
+
+  const jshell_cmd_spec_t *spec = name != NULL ? jshell_find_command(name)
+                                               : NULL;
+  if (!is_tool(spec)) {
+    char message[160];
+    snprintf(message, sizeof(message), "unknown tool: %s",
+             name != NULL ? name : "(none)");
+    send_error(out, req, RPC_INVALID_PARAMS, message);
+    free(name);
+    return;
+  }
+
+  call.name = spec->name;
+  spec->describe_args(build_call_argv, &call);
+  if (call.error != NULL) {
+    send_error(out, req, RPC_INVALID_PARAMS, call.error);
+    strv_free(&call.argv);
+    free(name);
+    return;
+  }
+
+  char *out_data = NULL;
+  char *err_data = NULL;
+  size_t out_len = 0;
+  size_t err_len = 0;
+  int status = run_captured(spec, &call.argv, &out_data, &out_len,
+                            &err_data, &err_len);
+  strv_free(&call.argv);
+  free(name);
+  if (status < 0) {
+    send_error(out, req, RPC_INVALID_REQUEST, strerror(errno));
+    return;
+  }
+
+  jbox_json_writer_t w;
+  jbox_json_writer_init(&w, out, false);
+  begin_response(&w, req);
+  jbox_json_key(&w, "result");
+  jbox_json_begin_object(&w);
+  jbox_json_key(&w, "content");
+  jbox_json_begin_array(&w);
+  write_text_content(&w, out_data != NULL ? out_data : "", out_len);
+  if (err_len > 0) {
+    write_text_content(&w, err_data, err_len);
+  }
+  jbox_json_end_array(&w);
+  if (out_data != NULL && flatten_json_object(out_data, out_len)) {
+    jbox_json_key(&w, "structuredContent");
+    jbox_json_raw(&w, out_data);
+  }
+  jbox_json_key(&w, "isError");
+  jbox_json_bool(&w, status != 0);
+  jbox_json_key(&w, "_meta");
+  jbox_json_begin_object(&w);
+  jbox_json_key(&w, "exit_status");
+  jbox_json_int(&w, status);
+  jbox_json_end_object(&w);
+  jbox_json_end_object(&w);
+  end_response(&w);
+
+  free(out_data);
+  free(err_data);
+}
+
+
+/**
+ * Parse one message line into its id, method and params span.
+ * @param r Reader over the line.
+ * @param req Zeroed request to fill in.
+ * @return 0 on success, RPC_PARSE_ERROR or RPC_INVALID_REQUEST.
+ */
+static int parse_request(jbox_json_reader_t *r, McpRequest *req) {
+  jbox_json_event_t ev = jbox_json_next(r);
+  if (ev != JBOX_JSON_OBJECT_BEGIN) {
+    return ev == JBOX_JSON_ERROR ? RPC_PARSE_ERROR : RPC_INVALID_REQUEST;
+  }
+
+  while ((ev = jbox_json_next(r)) == JBOX_JSON_KEY) {
+    if (strcmp(r->text, "id") == 0) {
+      ev = jbox_json_next(r);
+      if (ev == JBOX_JSON_STRING || ev == JBOX_JSON_NUMBER) {
+        free(req->id);
+        req->id = strdup(r->text);
+        req->id_is_string = ev == JBOX_JSON_STRING;
+      } else if (jbox_json_skip(r, ev) != 0) {
+        return RPC_PARSE_ERROR;
+      }
+    } else if (strcmp(r->text, "method") == 0) {
+      free(req->method);
+      req->method = jbox_json_read_string(r);
+    } else if (strcmp(r->text, "params") == 0) {
+      const char *start = r->pos;
+      if (jbox_json_skip(r, jbox_json_next(r)) != 0) {
+        return RPC_PARSE_ERROR;
+      }
+      req->params = start;
+      req->params_len = (size_t)(r->pos - start);
+    } else if (jbox_json_skip(r, jbox_json_next(r)) != 0) {
+      return RPC_PARSE_ERROR;
+    }
+  }
+
+  if (ev != JBOX_JSON_OBJECT_END || jbox_json_next(r) != JBOX_JSON_DONE) {
+    return RPC_PARSE_ERROR;
+  }
+  return req->method != NULL ? 0 : RPC_INVALID_REQUEST;
+}
+
+
+/**
+ * Answer one message line. Notifications (no id) get no answer.
+ * @param out Protocol stream.
+ * @param line Message text.
+ * @param len Its length.
+ */
+static void handle_message(FILE *out, const char *line, size_t len) {
+  McpRequest req = {0};
+  jbox_json_reader_t r;
+  jbox_json_reader_init(&r, line, len);
+  int rc = parse_request(&r, &req);
+  jbox_json_reader_free(&r);
+
+  if (rc != 0) {
+    send_error(out, &req, rc, rc == RPC_PARSE_ERROR ? "parse error"
+                                                    : "invalid request");
+  } else if (req.id == NULL) {
+    // Notifications, such as notifications/initialized, need no answer
+  } else if (strcmp(req.method, "initialize") == 0) {
+    handle_initialize(out, &req);
+  } else if (strcmp(req.method, "tools/list") == 0) {
+    handle_tools_list(out, &req);
+  } else if (strcmp(req.method, "tools/call") == 0) {
+    handle_tools_call(out, &req);
+  } else if (strcmp(req.method, "ping") == 0) {
+    jbox_json_writer_t w;
+    jbox_json_writer_init(&w, out, false);
+    begin_response(&w, &req);
+    jbox_json_key(&w, "result");
+    jbox_json_begin_object(&w);
+    jbox_json_end_object(&w);
+    end_response(&w);
+  } else {
+    send_error(out, &req, RPC_METHOD_NOT_FOUND, "method not found");
+  }
+
+  free(req.id);
+  free(req.method);
+}
+
+
+/**
+ * Serve MCP messages on stdin/stdout until stdin ends.
+ * @return 0 at end of input, 1 on setup failure.
+ */
+int jshell_mcp_serve(void) {
+  int in_fd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 3);
+  int out_fd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+  FILE *in = in_fd >= 0 ? fdopen(in_fd, "r") : NULL;
+  FILE *out = out_fd >= 0 ? fdopen(out_fd, "w") : NULL;
+  if (in == NULL || out == NULL) {
+    perror("jshell: mcp");
+    return 1;
+  }
+
+  // Commands must not read the messages, nor write between them
+  int null_fd = open("/dev/null", O_RDONLY);
+  if (null_fd >= 0) {
+    dup2(null_fd, STDIN_FILENO);
+    close(null_fd);
+  }
+  fflush(stdout);
+  dup2(STDERR_FILENO, STDOUT_FILENO);
+
+  init_arg_kinds();
+
+  char *line = NULL;
+  size_t line_cap = 0;
+  ssize_t len;
+  while ((len = getline(&line, &line_cap, in)) != -1) {
+    if (line[strspn(line, " \t\r\n")] == '\0') {
+      continue;
+    }
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+      len--;
+    }
+    handle_message(out, line, (size_t)len);
+    if (ferror(out)) {
+      break;
+    }
+  }
+
+  free(line);
+  fclose(in);
+  fclose(out);
+  return 0;
+}
@@ -0,0 +1,14 @@
+#ifndef JSHELL_MCP_H
+#define JSHELL_MCP_H
+
+
+// Answer Model Context Protocol requests on stdin/stdout until stdin ends
+// Every command with a run entry point and an argtable is a tool whose
+// input schema is derived from the argtable; calls run the command
+// in-process with argv built from the arguments, see jshell_mcp.c
+// The shell must be initialized
+// Returns the shell exit status (0 once the client has closed stdin)
+int jshell_mcp_serve(void);
+
+
+#endif
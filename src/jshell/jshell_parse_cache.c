@@ -0,0 +1,256 @@
+/**
+ * @file jshell_parse_cache.c
+ * @brief LRU cache of lowered command lines.
+ *
+ * Agents tend to send the same command text over and over. The cache maps
+ * the exact line to its execution plan, so repeated lines skip parsing
+ * and lowering entirely. Plans are never modified by execution, so a
+ * cached plan can be run any number of times. The parse tree is built in
+ * a bump arena and dropped with one reset as soon as the plan is built.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Parser.h"
+#include "Printer.h"
+
+#include "jshell_parse_cache.h"
+#include "jshell_stats.h"
+#include "jshell_trace.h"
+#include "ast/jshell_ast_parser.h"
+#include "utils/jbox_utils.h"
+
+
+#define PARSE_CACHE_BUCKETS 512
+
+
+/** A cached line and its execution plan */
+typedef struct ParseCacheEntry {
+  char* line;
+  JShellPlan* plan;
+  struct ParseCacheEntry* bucket_next;
+  struct ParseCacheEntry* lru_prev;   /* Towards most recently used */
+  struct ParseCacheEntry* lru_next;   /* Towards least recently used */
+} ParseCacheEntry;
+
+
+/** Hash buckets of cached lines */
+static ParseCacheEntry* g_buckets[PARSE_CACHE_BUCKETS];
+
+/** Most and least recently used entries */
+static ParseCacheEntry* g_lru_head = NULL;
+static ParseCacheEntry* g_lru_tail = NULL;
+
+/** Plan returned without being cached because allocation failed */
+static JShellPlan* g_uncached_plan = NULL;
+
+/** Parser whose arena holds the tree of a missed line */
+static JShellParser g_parser;
+
+static size_t g_entry_count = 0;
+static unsigned long g_hits = 0;
+static unsigned long g_misses = 0;
+
+
+/**
+ * Compute the bucket for a command line (FNV-1a).
+ * @param line Command line text.
+ * @return Bucket index.
+ */
+static size_t parse_cache_hash(const char* line) {
+  unsigned long hash = 2166136261UL;
+  for (const unsigned char* p = (const unsigned char*)line; *p; p++) {
+    hash ^= *p;
+    hash *= 16777619UL;
+  }
+  return hash % PARSE_CACHE_BUCKETS;
+}
+
+
+/**
+ * Unlink an entry from the LRU list.
+ * @param entry Entry to unlink.
+ */
+static void lru_unlink(ParseCacheEntry* entry) {
+  if (entry->lru_prev != NULL) {
+    entry->lru_prev->lru_next = entry->lru_next;
+  } else {
+    g_lru_head = entry->lru_next;
+  }
+  if (entry->lru_next != NULL) {
+    entry->lru_next->lru_prev = entry->lru_prev;
+  } else {
+    g_lru_tail = entry->lru_prev;
+  }
+  entry->lru_prev = NULL;
+  entry->lru_next = NULL;
+}
+
+
+/**
+ * Insert an entry at the most recently used end of the LRU list.
+ * @param entry Entry to insert.
+ */
+static void lru_push_front(ParseCacheEntry* entry) {
+  entry->lru_prev = NULL;
+  entry->lru_next = g_lru_head;
+  if (g_lru_head != NULL) {
+    g_lru_head->lru_prev = entry;
+  }
+  g_lru_head = entry;
+  if (g_lru_tail == NULL) {
+    g_lru_tail = entry;
+  }
+}
+
+
+/**
+ * Free an entry and its plan (must already be unlinked).
+ * @param entry Entry to free.
+ */
+static void free_entry(ParseCacheEntry* entry) {
+  jshell_plan_free(entry->plan);
+  free(entry->line);
+  free(entry);
+}
+
+
+/**
+ * Remove the least recently used entry.
+ */
+static void evict_lru(void) {
+  ParseCacheEntry* victim = g_lru_tail;
+  if (victim == NULL) {
+    return;
+  }
+
+  ParseCacheEntry** link = &g_buckets[parse_cache_hash(victim->line)];
+  while (*link != victim) {
+    link = &(*link)->bucket_next;
+  }
+  *link = victim->bucket_next;
+
+  lru_unlink(victim);
+  DPRINT("Parse cache evict: %s", victim->line);
+  free_entry(victim);
+  g_entry_count--;
+}
+
+
+/**
+ * Return the plan for a command line, parsing and lowering it on a miss.
+ *
+ * The returned plan is owned by the cache. It stays valid at least until
+ * the next call into the cache, so callers must not free it and must not
+ * hold on to it across another lookup.
+ *
+ * @param line Command line text.
+ * @return Execution plan, or NULL if the line does not parse.
+ */
+const JShellPlan* jshell_parse_cache_get(const char* line) {
+  if (line == NULL) {
+    return NULL;
+  }
+
+  if (g_uncached_plan != NULL) {
+    jshell_plan_free(g_uncached_plan);
+    g_uncached_plan = NULL;
+  }
+
+  size_t bucket = parse_cache_hash(line);
+  for (ParseCacheEntry* entry = g_buckets[bucket]; entry != NULL;
+       entry = entry->bucket_next) {
+    if (strcmp(entry->line, line) == 0) {
+      g_hits++;
+      jshell_stats_add(JSHELL_STAT_PARSE_HITS, 1);
+      lru_unlink(entry);
+      lru_push_front(entry);
+      DPRINT("Parse cache hit: %s", line);
+      return entry->plan;
+    }
+  }
+
+  g_misses++;
+  jshell_stats_add(JSHELL_STAT_PARSE_MISSES, 1);
+  uint64_t trace_start = jshell_trace_begin();
+  Input tree = jshell_parser_parse(&g_parser, line);
+  jshell_trace_end("parse", line, trace_start);
+  if (tree == NULL) {
+    jshell_parser_reset(&g_parser);
+    return NULL;
+  }
+
+  DPRINT("%s", showInput(tree));
+  trace_start = jshell_trace_begin();
+  JShellPlan* plan = jshell_plan_build(tree);
+  jshell_trace_end("plan", line, trace_start);
+  jshell_parser_reset(&g_parser);
+  if (plan == NULL) {
+    return NULL;
+  }
+
+  ParseCacheEntry* entry = calloc(1, sizeof(ParseCacheEntry));
+  char* line_copy = strdup(line);
+  if (entry == NULL || line_copy == NULL) {
+    /* Cannot cache it; hand it out until the next lookup frees it */
+    free(entry);
+    free(line_copy);
+    g_uncached_plan = plan;
+    return plan;
+  }
+
+  if (g_entry_count >= PARSE_CACHE_CAPACITY) {
+    evict_lru();
+  }
+
+  entry->line = line_copy;
+  entry->plan = plan;
+  entry->bucket_next = g_buckets[bucket];
+  g_buckets[bucket] = entry;
+  lru_push_front(entry);
+  g_entry_count++;
+
+  return plan;
+}
+
+
+/**
+ * Free all cached plans. Hit and miss counters are kept.
+ */
+void jshell_parse_cache_clear(void) {
+  ParseCacheEntry* entry = g_lru_head;
+  while (entry != NULL) {
+    ParseCacheEntry* next = entry->lru_next;
+    free_entry(entry);
+    entry = next;
+  }
+
+  if (g_uncached_plan != NULL) {
+    jshell_plan_free(g_uncached_plan);
+    g_uncached_plan = NULL;
+  }
+
+  jshell_parser_destroy(&g_parser);
+  memset(g_buckets, 0, sizeof(g_buckets));
+  g_lru_head = NULL;
+  g_lru_tail = NULL;
+  g_entry_count = 0;
+}
+
+
+/**
+ * Report the cache counters.
+ * @param stats Filled with hits, misses, current entries and capacity.
+ */
+void jshell_parse_cache_get_stats(JShellParseCacheStats* stats) {
+  if (stats == NULL) {
+    return;
+  }
+
+  stats->hits = g_hits;
+  stats->misses = g_misses;
+  stats->entries = g_entry_count;
+  stats->capacity = PARSE_CACHE_CAPACITY;
+}
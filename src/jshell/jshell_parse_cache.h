@@ -0,0 +1,34 @@
+#ifndef JSHELL_PARSE_CACHE_H
+#define JSHELL_PARSE_CACHE_H
+
+#include <stddef.h>
+
+#include "ast/jshell_ast_plan.h"
+
+
+// Maximum number of plans kept by the cache
+#define PARSE_CACHE_CAPACITY 256
+
+
+// Parse cache counters
+typedef struct {
+  unsigned long hits;
+  unsigned long misses;
+  size_t entries;
+  size_t capacity;
+} JShellParseCacheStats;
+
+
+// Return the execution plan for line, parsing and lowering it on a miss
+// The plan is owned by the cache and stays valid until the next call
+// Returns NULL on parse error (errors are not cached)
+const JShellPlan* jshell_parse_cache_get(const char* line);
+
+// Free all cached plans (counters are kept)
+void jshell_parse_cache_clear(void);
+
+// Fill stats with the current cache counters
+void jshell_parse_cache_get_stats(JShellParseCacheStats* stats);
+
+
+#endif
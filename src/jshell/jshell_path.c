@@ -4,7 +4,12 @@
  *
  * Handles initialization of jshell's binary directory (~/.jshell/bin),
  * PATH environment variable updates, and command resolution for external
- * executables.
+ * executables. Resolved commands are remembered in a bash-style hash table
+ * that is invalidated when PATH changes or when the modification time of a
+ * directory that could shadow or remove a cached entry changes. The table
+ * is shared by every thread that resolves commands (xargs and parallel
+ * workers among them), so it is only touched under g_cache_lock and
+ * callers always get their own copy of a path.
  */
 
 #define _POSIX_C_SOURCE 200809L
@@ -15,15 +20,20 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <pwd.h>
+#include <pthread.h>
 #include <errno.h>
 
 #include "jshell_path.h"
 #include "jshell_cmd_registry.h"
+#include "jshell_stats.h"
+#include "jshell_trace.h"
+#include "jshell_vars.h"
 #include "utils/jbox_utils.h"
 
 
 #define JSHELL_BIN_SUBPATH "/.jshell/bin"
 #define MAX_PATH_LEN 4096
+#define PATH_CACHE_BUCKETS 256
 
 
 /** Path to jshell's binary directory */
@@ -33,6 +43,45 @@ static char g_jshell_bin_dir[MAX_PATH_LEN] = {0};
 static int g_path_initialized = 0;
 
 
+/** A search directory and its modification time when the cache was built */
+typedef struct {
+  char* path;
+  struct timespec mtime;
+  int exists;
+  int in_path;  /* 0 only for the bin directory when PATH omits it */
+} PathCacheDir;
+
+
+/** A cached name -> absolute path resolution */
+typedef struct PathCacheEntry {
+  char* name;
+  char* path;
+  size_t dir_index;  /* Index into g_cache_dirs where the command was found */
+  unsigned long hits;
+  struct PathCacheEntry* next;
+} PathCacheEntry;
+
+
+/** Guards every g_cache_* variable below */
+static pthread_mutex_t g_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Hash buckets of cached resolutions */
+static PathCacheEntry* g_cache_buckets[PATH_CACHE_BUCKETS];
+
+/**
+ * Directories searched, in order: the jshell bin directory followed by
+ * each PATH entry not equal to it.
+ */
+static PathCacheDir* g_cache_dirs = NULL;
+static size_t g_cache_dir_count = 0;
+
+/** Copy of PATH the directory snapshot was taken from (NULL = no snapshot) */
+static char* g_cache_path_env = NULL;
+
+/** Variable generation at which PATH was last compared with the snapshot */
+static unsigned long g_cache_vars_generation = 0;
+
+
 /**
  * Recursively creates directories along a path.
  *
@@ -78,7 +127,7 @@ static int make_directory_recursive(const char* path) {
  * @return Pointer to home directory string, or NULL if not found.
  */
 static const char* get_home_directory(void) {
-  const char* home = getenv("HOME");
+  const char* home = jshell_var_get("HOME");
   if (home != NULL && home[0] != '\0') {
     return home;
   }
@@ -120,19 +169,19 @@ void jshell_init_path(void) {
             g_jshell_bin_dir, strerror(errno));
   }
 
-  const char* current_path = getenv("PATH");
+  const char* current_path = jshell_var_get("PATH");
   if (current_path != NULL) {
     size_t new_path_len = strlen(g_jshell_bin_dir) + 1 + strlen(current_path)
                           + 1;
     char* new_path = malloc(new_path_len);
     if (new_path != NULL) {
       snprintf(new_path, new_path_len, "%s:%s", g_jshell_bin_dir, current_path);
-      setenv("PATH", new_path, 1);
+      jshell_var_set("PATH", new_path, JSHELL_VAR_EXPORT);
       free(new_path);
       DPRINT("PATH updated: %s prepended", g_jshell_bin_dir);
     }
   } else {
-    setenv("PATH", g_jshell_bin_dir, 1);
+    jshell_var_set("PATH", g_jshell_bin_dir, JSHELL_VAR_EXPORT);
   }
 
   g_path_initialized = 1;
@@ -156,59 +205,225 @@ const char* jshell_get_bin_dir(void) {
 
 
 /**
- * Searches the system PATH for an executable command.
+ * Hashes a command name for bucket selection (djb2).
  *
- * Iterates through directories in the PATH environment variable
- * and checks for an executable file with the given name.
+ * @param name Command name.
+ * @return Bucket index.
+ */
+static size_t path_cache_hash(const char* name) {
+  size_t hash = 5381;
+  for (const unsigned char* p = (const unsigned char*)name; *p; p++) {
+    hash = (hash * 33) ^ *p;
+  }
+  return hash % PATH_CACHE_BUCKETS;
+}
+
+
+/**
+ * Reads the modification time of a directory.
  *
- * @param cmd_name Name of the command to search for.
- * @return Dynamically allocated full path to the command if found,
- *         NULL otherwise. Caller must free the returned string.
+ * @param path Directory path.
+ * @param mtime Receives the modification time.
+ * @return 1 if the directory exists, 0 otherwise.
  */
-static char* search_path_for_command(const char* cmd_name) {
-  const char* path_env = getenv("PATH");
-  if (path_env == NULL || cmd_name == NULL) {
-    return NULL;
+static int read_dir_mtime(const char* path, struct timespec* mtime) {
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    mtime->tv_sec = 0;
+    mtime->tv_nsec = 0;
+    return 0;
+  }
+  *mtime = st.st_mtim;
+  return 1;
+}
+
+
+/**
+ * Frees every cached entry and the directory snapshot.
+ * Called with g_cache_lock held.
+ */
+static void path_cache_reset(void) {
+  for (size_t i = 0; i < PATH_CACHE_BUCKETS; i++) {
+    PathCacheEntry* entry = g_cache_buckets[i];
+    while (entry != NULL) {
+      PathCacheEntry* next = entry->next;
+      free(entry->name);
+      free(entry->path);
+      free(entry);
+      entry = next;
+    }
+    g_cache_buckets[i] = NULL;
+  }
+
+  for (size_t i = 0; i < g_cache_dir_count; i++) {
+    free(g_cache_dirs[i].path);
+  }
+  free(g_cache_dirs);
+  g_cache_dirs = NULL;
+  g_cache_dir_count = 0;
+
+  free(g_cache_path_env);
+  g_cache_path_env = NULL;
+}
+
+
+/**
+ * Appends a directory to the search snapshot, recording its mtime.
+ *
+ * @param dir Directory path.
+ * @param in_path Whether the directory is an entry of PATH.
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int path_cache_add_dir(const char* dir, int in_path) {
+  PathCacheDir* grown = realloc(g_cache_dirs,
+                                (g_cache_dir_count + 1) * sizeof(*grown));
+  if (grown == NULL) {
+    return -1;
+  }
+  g_cache_dirs = grown;
+
+  PathCacheDir* entry = &g_cache_dirs[g_cache_dir_count];
+  entry->path = strdup(dir);
+  if (entry->path == NULL) {
+    return -1;
+  }
+  entry->exists = read_dir_mtime(dir, &entry->mtime);
+  entry->in_path = in_path;
+  g_cache_dir_count++;
+  return 0;
+}
+
+
+/**
+ * Makes sure the directory snapshot matches the current PATH.
+ *
+ * Rebuilds the snapshot (dropping all cached entries) when PATH has
+ * changed since it was taken. PATH is only read again once some shell
+ * variable has changed.
+ *
+ * @return 0 if a usable snapshot exists, -1 otherwise.
+ */
+static int path_cache_sync_path(void) {
+  unsigned long generation = jshell_vars_generation();
+  if (g_cache_path_env != NULL && g_cache_vars_generation == generation) {
+    return 0;
+  }
+
+  char* path_env = jshell_var_dup("PATH");
+  if (path_env == NULL) {
+    path_env = strdup("");
+    if (path_env == NULL) {
+      return -1;
+    }
+  }
+
+  if (g_cache_path_env != NULL && strcmp(g_cache_path_env, path_env) == 0) {
+    g_cache_vars_generation = generation;
+    free(path_env);
+    return 0;
+  }
+
+  path_cache_reset();
+  g_cache_path_env = path_env;
+  g_cache_vars_generation = generation;
+
+  if (g_jshell_bin_dir[0] != '\0'
+      && path_cache_add_dir(g_jshell_bin_dir, 0) != 0) {
+    path_cache_reset();
+    return -1;
   }
 
   char* path_copy = strdup(path_env);
   if (path_copy == NULL) {
-    return NULL;
+    path_cache_reset();
+    return -1;
   }
 
-  char full_path[MAX_PATH_LEN];
   char* saveptr = NULL;
-  char* dir = strtok_r(path_copy, ":", &saveptr);
-
-  while (dir != NULL) {
-    snprintf(full_path, sizeof(full_path), "%s/%s", dir, cmd_name);
-
-    if (access(full_path, X_OK) == 0) {
+  for (char* dir = strtok_r(path_copy, ":", &saveptr); dir != NULL;
+       dir = strtok_r(NULL, ":", &saveptr)) {
+    if (g_jshell_bin_dir[0] != '\0' && strcmp(dir, g_jshell_bin_dir) == 0) {
+      g_cache_dirs[0].in_path = 1;
+      continue;
+    }
+    if (path_cache_add_dir(dir, 1) != 0) {
       free(path_copy);
-      return strdup(full_path);
+      path_cache_reset();
+      return -1;
     }
-
-    dir = strtok_r(NULL, ":", &saveptr);
   }
 
   free(path_copy);
-  return NULL;
+  DPRINT("Path cache snapshot rebuilt: %zu directories", g_cache_dir_count);
+  return 0;
 }
 
 
 /**
- * Resolves a command name to its full executable path.
+ * Checks that no directory up to and including dir_index has changed.
  *
- * Resolution order:
- * 1. If cmd_name starts with '/' or '.', treat as absolute/relative path
- * 2. If command is registered as external, check jshell bin directory
- * 3. Search system PATH
+ * A change in an earlier directory may mean a new command now shadows the
+ * cached one; a change in the entry's own directory may mean it was removed
+ * or replaced.
  *
- * @param cmd_name Name or path of the command to resolve.
- * @return Dynamically allocated full path to the executable if found,
+ * @param dir_index Last directory index to check.
+ * @return 1 if all checked directories are unchanged, 0 otherwise.
+ */
+static int path_cache_dirs_unchanged(size_t dir_index) {
+  for (size_t i = 0; i <= dir_index && i < g_cache_dir_count; i++) {
+    struct timespec mtime;
+    int exists = read_dir_mtime(g_cache_dirs[i].path, &mtime);
+    if (exists != g_cache_dirs[i].exists
+        || mtime.tv_sec != g_cache_dirs[i].mtime.tv_sec
+        || mtime.tv_nsec != g_cache_dirs[i].mtime.tv_nsec) {
+      DPRINT("Path cache invalidated: %s changed", g_cache_dirs[i].path);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+
+/**
+ * Searches the snapshot directories for an executable command.
+ *
+ * The jshell bin directory is only considered for commands registered as
+ * external, matching the historical resolution order.
+ *
+ * @param cmd_name Name of the command to search for.
+ * @param dir_index Receives the index of the directory it was found in.
+ * @return Dynamically allocated full path to the command if found,
  *         NULL otherwise. Caller must free the returned string.
  */
-char* jshell_resolve_command(const char* cmd_name) {
+static char* search_dirs_for_command(const char* cmd_name,
+                                     size_t* dir_index) {
+  const jshell_cmd_spec_t* spec = jshell_find_command(cmd_name);
+  int check_bin_dir = (spec != NULL && spec->type == CMD_EXTERNAL);
+  char full_path[MAX_PATH_LEN];
+
+  for (size_t i = 0; i < g_cache_dir_count; i++) {
+    if (!g_cache_dirs[i].in_path && !check_bin_dir) {
+      continue;
+    }
+
+    snprintf(full_path, sizeof(full_path), "%s/%s", g_cache_dirs[i].path,
+             cmd_name);
+    if (access(full_path, X_OK) == 0) {
+      *dir_index = i;
+      return strdup(full_path);
+    }
+  }
+
+  return NULL;
+}
+
+
+/**
+ * Resolve a command; see jshell_resolve_command().
+ * Called with g_cache_lock held.
+ * @return Allocated path, or NULL if not found.
+ */
+static char* resolve_command(const char* cmd_name) {
   if (cmd_name == NULL || cmd_name[0] == '\0') {
     return NULL;
   }
@@ -220,41 +435,134 @@ char* jshell_resolve_command(const char* cmd_name) {
     return NULL;
   }
 
-  const jshell_cmd_spec_t* spec = jshell_find_command(cmd_name);
+  if (path_cache_sync_path() != 0) {
+    return NULL;
+  }
 
-  if (spec != NULL && spec->type == CMD_EXTERNAL) {
-    if (g_jshell_bin_dir[0] != '\0') {
-      size_t path_len = strlen(g_jshell_bin_dir) + 1 + strlen(cmd_name) + 1;
-      char* local_path = malloc(path_len);
-      if (local_path != NULL) {
-        snprintf(local_path, path_len, "%s/%s", g_jshell_bin_dir, cmd_name);
-
-        if (access(local_path, X_OK) == 0) {
-          DPRINT("Found command in jshell bin: %s", local_path);
-          return local_path;
-        }
-        free(local_path);
+  size_t bucket = path_cache_hash(cmd_name);
+  PathCacheEntry** link = &g_cache_buckets[bucket];
+
+  while (*link != NULL) {
+    PathCacheEntry* entry = *link;
+    if (strcmp(entry->name, cmd_name) == 0) {
+      if (path_cache_dirs_unchanged(entry->dir_index)) {
+        entry->hits++;
+        jshell_stats_add(JSHELL_STAT_PATH_HITS, 1);
+        DPRINT("Path cache hit: %s -> %s", cmd_name, entry->path);
+        return strdup(entry->path);
+      }
+      /* Directory contents changed: start over from a fresh snapshot */
+      path_cache_reset();
+      if (path_cache_sync_path() != 0) {
+        return NULL;
       }
+      break;
     }
+    link = &entry->next;
   }
 
-  char* system_path = search_path_for_command(cmd_name);
-  if (system_path != NULL) {
-    DPRINT("Found command in system PATH: %s", system_path);
-    return system_path;
+  jshell_stats_add(JSHELL_STAT_PATH_MISSES, 1);
+  size_t dir_index = 0;
+  char* resolved = search_dirs_for_command(cmd_name, &dir_index);
+  if (resolved == NULL) {
+    return NULL;
+  }
+  DPRINT("Resolved command: %s -> %s", cmd_name, resolved);
+
+  PathCacheEntry* entry = calloc(1, sizeof(PathCacheEntry));
+  if (entry != NULL) {
+    entry->name = strdup(cmd_name);
+    entry->path = strdup(resolved);
+    if (entry->name == NULL || entry->path == NULL) {
+      free(entry->name);
+      free(entry->path);
+      free(entry);
+    } else {
+      entry->dir_index = dir_index;
+      entry->hits = 1;
+      entry->next = g_cache_buckets[bucket];
+      g_cache_buckets[bucket] = entry;
+    }
   }
 
-  return NULL;
+  return resolved;
+}
+
+
+/**
+ * Resolves a command name to its full executable path.
+ *
+ * Resolution order:
+ * 1. If cmd_name starts with '/' or '.', treat as absolute/relative path
+ * 2. If command is registered as external, check jshell bin directory
+ * 3. Search system PATH
+ *
+ * Results of steps 2 and 3 are cached; a cached entry is reused while PATH
+ * is unchanged and none of the directories searched before finding it have
+ * been modified.
+ *
+ * @param cmd_name Name or path of the command to resolve.
+ * @return Dynamically allocated full path to the executable if found,
+ *         NULL otherwise. Caller must free the returned string.
+ */
+char* jshell_resolve_command(const char* cmd_name) {
+  uint64_t trace_start = jshell_trace_begin();
+  pthread_mutex_lock(&g_cache_lock);
+  char* resolved = resolve_command(cmd_name);
+  pthread_mutex_unlock(&g_cache_lock);
+  jshell_trace_end("resolve", cmd_name, trace_start);
+  return resolved;
+}
+
+
+/**
+ * Forgets every cached command resolution.
+ */
+void jshell_path_cache_clear(void) {
+  pthread_mutex_lock(&g_cache_lock);
+  path_cache_reset();
+  pthread_mutex_unlock(&g_cache_lock);
+}
+
+
+/**
+ * Invokes a callback for every cached command resolution.
+ *
+ * The cache is locked while the callback runs, so it must not resolve
+ * commands itself.
+ *
+ * @param callback Function called with name, path and hit count.
+ * @param userdata Opaque pointer passed to the callback.
+ */
+void jshell_path_cache_for_each(
+    void (*callback)(const char* name, const char* path,
+                     unsigned long hits, void* userdata),
+    void* userdata) {
+  if (callback == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&g_cache_lock);
+  for (size_t i = 0; i < PATH_CACHE_BUCKETS; i++) {
+    for (PathCacheEntry* entry = g_cache_buckets[i]; entry != NULL;
+         entry = entry->next) {
+      callback(entry->name, entry->path, entry->hits, userdata);
+    }
+  }
+  pthread_mutex_unlock(&g_cache_lock);
 }
 
 
 /**
  * Cleans up the path system state.
  *
- * Resets initialization flags and clears the bin directory path.
- * Used during shell shutdown or reinitialization.
+ * Resets initialization flags, clears the bin directory path and drops
+ * the command resolution cache. Used during shell shutdown or
+ * reinitialization.
  */
 void jshell_cleanup_path(void) {
+  pthread_mutex_lock(&g_cache_lock);
+  path_cache_reset();
+  pthread_mutex_unlock(&g_cache_lock);
   g_path_initialized = 0;
   g_jshell_bin_dir[0] = '\0';
 }
@@ -17,8 +17,20 @@ const char* jshell_get_bin_dir(void);
 //   - Full path from system PATH if found
 //   - NULL if not found anywhere
 // Caller is responsible for freeing the returned string
+// Results are cached until PATH or a searched directory changes
+// Safe to call from any thread; the cache is locked internally
 char* jshell_resolve_command(const char* cmd_name);
 
+// Forget all cached command resolutions
+void jshell_path_cache_clear(void);
+
+// Call callback for each cached resolution (name, path, hit count)
+// The cache stays locked meanwhile: callback must not resolve commands
+void jshell_path_cache_for_each(
+  void (*callback)(const char* name, const char* path,
+                   unsigned long hits, void* userdata),
+  void* userdata);
+
 // Cleanup path system resources
 void jshell_cleanup_path(void);
 
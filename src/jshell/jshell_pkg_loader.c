@@ -2,629 +2,198 @@
  * @file jshell_pkg_loader.c
  * @brief Package loader for jshell installed packages.
  *
- * Parses ~/.jshell/pkgs/pkgdb.json and registers installed package commands
- * with the shell's command registry. This allows installed packages to be
- * available as commands in the shell.
+ * Registers installed package commands with the shell's command registry.
+ * Commands come from the binary index pkg keeps next to pkgdb.json
+ * (~/.jshell/pkgs/pkgdb.idx), which is mapped on first use and searched
+ * by name, so a command is only registered when it is first looked up and
+ * startup cost does not grow with the number of installed packages.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
-#include <libgen.h>
+#include <stdbool.h>
 #include <sys/stat.h>
 
 #include "jshell_pkg_loader.h"
 #include "jshell_cmd_registry.h"
+#include "jshell_stats.h"
+#include "apps/pkg/pkg_db.h"
+#include "apps/pkg/pkg_index.h"
+#include "apps/pkg/pkg_utils.h"
+#include "utils/jbox_utils.h"
 
 
-// ---------------------------------------------------------------------------
-// Path Utilities (static - internal use only)
-// ---------------------------------------------------------------------------
-
-/**
- * Gets the jshell home directory path.
- *
- * @return Dynamically allocated path to ~/.jshell, or NULL on error.
- *         Caller must free the returned string.
- */
-static char *get_home_dir(void) {
-  const char *home = getenv("HOME");
-  if (home == NULL) {
-    return NULL;
-  }
-
-  size_t len = strlen(home) + strlen("/.jshell") + 1;
-  char *path = malloc(len);
-  if (path == NULL) {
-    return NULL;
-  }
-
-  snprintf(path, len, "%s/.jshell", home);
-  return path;
-}
+/** Mapped command index, valid while g_index_open is true */
+static PkgIndex g_index;
 
+/** Whether g_index is mapped */
+static bool g_index_open = false;
 
-/**
- * Gets the jshell binary directory path.
- *
- * @return Dynamically allocated path to ~/.jshell/bin, or NULL on error.
- *         Caller must free the returned string.
- */
-static char *get_bin_dir(void) {
-  char *home = get_home_dir();
-  if (home == NULL) {
-    return NULL;
-  }
-
-  size_t len = strlen(home) + strlen("/bin") + 1;
-  char *path = malloc(len);
-  if (path == NULL) {
-    free(home);
-    return NULL;
-  }
-
-  snprintf(path, len, "%s/bin", home);
-  free(home);
-  return path;
-}
+/** Set when the index could not be built, so misses don't retry it */
+static bool g_index_failed = false;
 
-
-/**
- * Gets the package database file path.
- *
- * @return Dynamically allocated path to ~/.jshell/pkgs/pkgdb.json, or NULL on
- *         error. Caller must free the returned string.
- */
-static char *get_pkgdb_path(void) {
-  char *home = get_home_dir();
-  if (home == NULL) {
-    return NULL;
-  }
-
-  size_t len = strlen(home) + strlen("/pkgs/pkgdb.json") + 1;
-  char *path = malloc(len);
-  if (path == NULL) {
-    free(home);
-    return NULL;
-  }
-
-  snprintf(path, len, "%s/pkgs/pkgdb.json", home);
-  free(home);
-  return path;
-}
-
-
-// ---------------------------------------------------------------------------
-// Simple JSON Parser for pkgdb.json
-// ---------------------------------------------------------------------------
-
-/**
- * Skips whitespace characters in a string.
- *
- * @param s String to process.
- * @return Pointer to the first non-whitespace character.
- */
-static const char *skip_ws(const char *s) {
-  while (*s && isspace((unsigned char)*s)) {
-    s++;
-  }
-  return s;
-}
+/** Whether commands are registered lazily through the registry loader */
+static bool g_loading_deferred = false;
 
 
 /**
- * Parses a JSON string value.
- *
- * Handles escape sequences like \n, \t, \r, \", and \\.
+ * Maps the package index, rebuilding it from pkgdb.json if it is missing
+ * or was left behind by a pkg that did not maintain it.
  *
- * @param p Pointer to current position in JSON (will be updated to position
- *          after the parsed string).
- * @return Dynamically allocated unescaped string, or NULL on parse error.
- *         Caller must free the returned string.
+ * @return true if the index is available.
  */
-static char *parse_str(const char **p) {
-  const char *s = *p;
-  s = skip_ws(s);
-
-  if (*s != '"') {
-    return NULL;
+static bool ensure_index(void) {
+  if (g_index_open) {
+    return true;
   }
-  s++;
-
-  const char *start = s;
-  while (*s && *s != '"') {
-    if (*s == '\\' && *(s + 1)) {
-      s += 2;
-    } else {
-      s++;
-    }
+  if (g_index_failed) {
+    return false;
   }
 
-  if (*s != '"') {
-    return NULL;
-  }
-
-  size_t len = (size_t)(s - start);
-  char *result = malloc(len + 1);
-  if (result == NULL) {
-    return NULL;
-  }
-
-  size_t j = 0;
-  for (size_t i = 0; i < len; i++) {
-    if (start[i] == '\\' && i + 1 < len) {
-      i++;
-      switch (start[i]) {
-        case 'n': result[j++] = '\n'; break;
-        case 't': result[j++] = '\t'; break;
-        case 'r': result[j++] = '\r'; break;
-        case '"': result[j++] = '"'; break;
-        case '\\': result[j++] = '\\'; break;
-        default: result[j++] = start[i]; break;
-      }
-    } else {
-      result[j++] = start[i];
+  if (pkg_index_open(&g_index) != 0) {
+    DPRINT("Package index missing or stale, rebuilding from pkgdb.json");
+    PkgDb *db = pkg_db_load();
+    int rc = db != NULL ? pkg_index_write(db) : -1;
+    pkg_db_free(db);
+    if (rc != 0 || pkg_index_open(&g_index) != 0) {
+      g_index_failed = true;
+      return false;
     }
   }
-  result[j] = '\0';
 
-  *p = s + 1;
-  return result;
+  g_index_open = true;
+  return true;
 }
 
 
 /**
- * Parses a JSON array of strings.
+ * Registers the indexed command at a position if its binary is installed.
  *
- * @param p Pointer to current position in JSON (will be updated to position
- *          after the parsed array).
- * @param count Output parameter for number of strings in the array.
- * @return Dynamically allocated array of string pointers, or NULL on parse
- *         error. Both the array and each string must be freed by the caller.
+ * @param i Position in the index.
+ * @return true if the command was registered.
  */
-static char **parse_str_array(const char **p, int *count) {
-  const char *s = *p;
-  s = skip_ws(s);
-
-  if (*s != '[') {
-    *count = 0;
-    return NULL;
+static bool register_indexed_command(size_t i) {
+  const char *name = pkg_index_name(&g_index, i);
+  char *bin_dir = pkg_get_bin_dir();
+  if (bin_dir == NULL || name[0] == '\0') {
+    free(bin_dir);
+    return false;
   }
-  s++;
-
-  char **items = NULL;
-  int capacity = 0;
-  *count = 0;
-
-  while (1) {
-    s = skip_ws(s);
-
-    if (*s == ']') {
-      s++;
-      break;
-    }
-
-    if (*count > 0) {
-      if (*s != ',') {
-        goto error;
-      }
-      s++;
-      s = skip_ws(s);
-    }
 
-    char *item = parse_str(&s);
-    if (item == NULL) {
-      goto error;
-    }
+  size_t path_len = strlen(bin_dir) + strlen(name) + 2;
+  char *bin_path = malloc(path_len);
+  bool registered = false;
+  if (bin_path != NULL) {
+    snprintf(bin_path, path_len, "%s/%s", bin_dir, name);
 
-    if (*count >= capacity) {
-      capacity = capacity == 0 ? 4 : capacity * 2;
-      char **new_items = realloc(items, (size_t)capacity * sizeof(char *));
-      if (new_items == NULL) {
-        free(item);
-        goto error;
-      }
-      items = new_items;
+    struct stat st;
+    if (stat(bin_path, &st) == 0) {
+      registered = jshell_register_package_command(
+        name, pkg_index_summary(&g_index, i), bin_path) == 0;
     }
-
-    items[*count] = item;
-    (*count)++;
+    free(bin_path);
   }
 
-  *p = s;
-  return items;
-
-error:
-  for (int i = 0; i < *count; i++) {
-    free(items[i]);
-  }
-  free(items);
-  *count = 0;
-  return NULL;
+  free(bin_dir);
+  return registered;
 }
 
 
 /**
- * Skips over a JSON value without parsing it.
+ * Registry callback for a lookup miss: registers name if a package
+ * provides it.
  *
- * Handles strings, arrays, objects, and primitive values.
- *
- * @param s Current position in JSON.
- * @return Pointer to position after the skipped value.
+ * @param name Command name that was not found.
  */
-static const char *skip_val(const char *s) {
-  s = skip_ws(s);
-
-  if (*s == '"') {
-    s++;
-    while (*s && *s != '"') {
-      if (*s == '\\' && *(s + 1)) {
-        s += 2;
-      } else {
-        s++;
-      }
-    }
-    if (*s == '"') s++;
-    return s;
-  }
-
-  if (*s == '[') {
-    s++;
-    int depth = 1;
-    while (*s && depth > 0) {
-      if (*s == '[') depth++;
-      else if (*s == ']') depth--;
-      else if (*s == '"') {
-        s++;
-        while (*s && *s != '"') {
-          if (*s == '\\' && *(s + 1)) s += 2;
-          else s++;
-        }
-        if (*s == '"') s++;
-        continue;
-      }
-      s++;
-    }
-    return s;
-  }
-
-  if (*s == '{') {
-    s++;
-    int depth = 1;
-    while (*s && depth > 0) {
-      if (*s == '{') depth++;
-      else if (*s == '}') depth--;
-      else if (*s == '"') {
-        s++;
-        while (*s && *s != '"') {
-          if (*s == '\\' && *(s + 1)) s += 2;
-          else s++;
-        }
-        if (*s == '"') s++;
-        continue;
-      }
-      s++;
-    }
-    return s;
+static void resolve_package_command(const char *name) {
+  if (!ensure_index()) {
+    return;
   }
 
-  while (*s && *s != ',' && *s != '}' && *s != ']') {
-    s++;
+  long i = pkg_index_find(&g_index, name);
+  if (i >= 0) {
+    DPRINT("Registering package command %s on first use", name);
+    register_indexed_command((size_t)i);
   }
-  return s;
 }
 
 
 /**
- * Package entry structure for parsing pkgdb.json entries.
- */
-typedef struct {
-  char *name;         /** Package name */
-  char *description;  /** Package description */
-  char **files;       /** Array of file paths in the package */
-  int files_count;    /** Number of files in the package */
-} PkgEntry;
-
-
-/**
- * Frees memory allocated for a package entry.
- *
- * @param e Package entry to free.
+ * Registry callback before listing: registers every package command.
  */
-static void free_pkg_entry(PkgEntry *e) {
-  if (e == NULL) return;
-  free(e->name);
-  free(e->description);
-  for (int i = 0; i < e->files_count; i++) {
-    free(e->files[i]);
-  }
-  free(e->files);
+static void load_all_package_commands(void) {
+  jshell_load_installed_packages();
 }
 
 
-/**
- * Parses a single package entry object from JSON.
- *
- * @param p Pointer to current position in JSON (will be updated to position
- *          after the parsed entry).
- * @param entry Package entry structure to populate.
- * @return 0 on success, -1 on parse error.
- */
-static int parse_pkg_entry(const char **p, PkgEntry *entry) {
-  const char *s = *p;
-  s = skip_ws(s);
-
-  if (*s != '{') {
-    return -1;
-  }
-  s++;
-
-  memset(entry, 0, sizeof(PkgEntry));
+/** Loader handed to the command registry */
+static const jshell_cmd_loader_t g_package_loader = {
+  .resolve = resolve_package_command,
+  .load_all = load_all_package_commands,
+};
 
-  int first = 1;
-  while (1) {
-    s = skip_ws(s);
-
-    if (*s == '}') {
-      s++;
-      break;
-    }
-
-    if (!first) {
-      if (*s != ',') {
-        goto error;
-      }
-      s++;
-      s = skip_ws(s);
-    }
-    first = 0;
-
-    char *key = parse_str(&s);
-    if (key == NULL) {
-      goto error;
-    }
-
-    s = skip_ws(s);
-    if (*s != ':') {
-      free(key);
-      goto error;
-    }
-    s++;
-    s = skip_ws(s);
-
-    if (strcmp(key, "name") == 0) {
-      entry->name = parse_str(&s);
-    } else if (strcmp(key, "description") == 0) {
-      entry->description = parse_str(&s);
-    } else if (strcmp(key, "files") == 0) {
-      entry->files = parse_str_array(&s, &entry->files_count);
-    } else {
-      s = skip_val(s);
-    }
-
-    free(key);
-  }
-
-  *p = s;
-  return 0;
-
-error:
-  free_pkg_entry(entry);
-  return -1;
-}
-
-
-// ---------------------------------------------------------------------------
-// Package Loading
-// ---------------------------------------------------------------------------
 
 /**
- * Reads an entire file into memory.
- *
- * @param path Path to the file to read.
- * @return Dynamically allocated string containing file contents, or NULL on
- *         error. Caller must free the returned string.
+ * Registers package commands lazily from now on.
  */
-static char *read_file(const char *path) {
-  FILE *f = fopen(path, "r");
-  if (f == NULL) {
-    return NULL;
-  }
-
-  if (fseek(f, 0, SEEK_END) != 0) {
-    fclose(f);
-    return NULL;
-  }
-
-  long size = ftell(f);
-  if (size < 0) {
-    fclose(f);
-    return NULL;
-  }
-
-  if (fseek(f, 0, SEEK_SET) != 0) {
-    fclose(f);
-    return NULL;
-  }
-
-  char *content = malloc((size_t)size + 1);
-  if (content == NULL) {
-    fclose(f);
-    return NULL;
-  }
-
-  size_t read = fread(content, 1, (size_t)size, f);
-  fclose(f);
-
-  content[read] = '\0';
-  return content;
+void jshell_defer_package_loading(void) {
+  g_loading_deferred = true;
+  jshell_set_command_loader(&g_package_loader);
 }
 
 
 /**
- * Loads installed packages from pkgdb.json and registers them with the shell.
+ * Registers every installed package command.
  *
- * Parses ~/.jshell/pkgs/pkgdb.json and registers each package's commands
- * with the shell's command registry. This allows installed packages to be
- * executed as commands.
+ * Commands that are already registered (including ones resolved lazily)
+ * are left as they are.
  *
- * @return Number of package commands successfully loaded, or 0 if no packages
- *         or database doesn't exist. Returns -1 on critical errors.
+ * @return Number of package commands newly registered, or -1 if the
+ *         package index cannot be read.
  */
 int jshell_load_installed_packages(void) {
-  char *db_path = get_pkgdb_path();
-  if (db_path == NULL) {
-    return 0;  // No packages, not an error
-  }
-
-  // Check if file exists
-  struct stat st;
-  if (stat(db_path, &st) != 0) {
-    free(db_path);
-    return 0;  // No database file, no packages
-  }
-
-  char *content = read_file(db_path);
-  free(db_path);
-
-  if (content == NULL) {
-    return 0;  // Can't read file, no packages
-  }
-
-  char *bin_dir = get_bin_dir();
-  if (bin_dir == NULL) {
-    free(content);
+  if (!ensure_index()) {
     return -1;
   }
 
   int packages_loaded = 0;
-  const char *s = content;
-  s = skip_ws(s);
-
-  if (*s != '{') {
-    free(content);
-    free(bin_dir);
-    return 0;
-  }
-  s++;
-
-  // Find "packages" array
-  int first = 1;
-  while (1) {
-    s = skip_ws(s);
-
-    if (*s == '}') {
-      break;
+  size_t count = pkg_index_count(&g_index);
+  for (size_t i = 0; i < count; i++) {
+    if (register_indexed_command(i)) {
+      packages_loaded++;
     }
-
-    if (!first) {
-      if (*s != ',') {
-        break;
-      }
-      s++;
-      s = skip_ws(s);
-    }
-    first = 0;
-
-    char *key = parse_str(&s);
-    if (key == NULL) {
-      break;
-    }
-
-    s = skip_ws(s);
-    if (*s != ':') {
-      free(key);
-      break;
-    }
-    s++;
-    s = skip_ws(s);
-
-    if (strcmp(key, "packages") == 0) {
-      // Parse packages array
-      if (*s != '[') {
-        free(key);
-        break;
-      }
-      s++;
-
-      int first_pkg = 1;
-      while (1) {
-        s = skip_ws(s);
-
-        if (*s == ']') {
-          s++;
-          break;
-        }
-
-        if (!first_pkg) {
-          if (*s != ',') {
-            break;
-          }
-          s++;
-          s = skip_ws(s);
-        }
-        first_pkg = 0;
-
-        PkgEntry entry;
-        if (parse_pkg_entry(&s, &entry) != 0) {
-          break;
-        }
-
-        // Register command for each file in the package
-        if (entry.name != NULL && entry.files != NULL) {
-          for (int i = 0; i < entry.files_count; i++) {
-            char *file = entry.files[i];
-            // Get basename of file (e.g., "bin/ls" -> "ls")
-            char *file_copy = strdup(file);
-            if (file_copy == NULL) continue;
-            char *cmd_name = basename(file_copy);
-
-            // Build full path to binary
-            size_t path_len = strlen(bin_dir) + strlen(cmd_name) + 2;
-            char *bin_path = malloc(path_len);
-            if (bin_path != NULL) {
-              snprintf(bin_path, path_len, "%s/%s", bin_dir, cmd_name);
-
-              // Check if binary exists
-              if (stat(bin_path, &st) == 0) {
-                if (jshell_register_package_command(cmd_name, entry.description,
-                                                    bin_path) == 0) {
-                  packages_loaded++;
-                }
-              }
-
-              free(bin_path);
-            }
-            free(file_copy);
-          }
-        }
-
-        free_pkg_entry(&entry);
-      }
-    } else {
-      s = skip_val(s);
-    }
-
-    free(key);
   }
 
-  free(content);
-  free(bin_dir);
-
   return packages_loaded;
 }
 
 
 /**
- * Reloads all installed packages.
+ * Picks up package installs and removals.
  *
- * Unregisters all currently loaded package commands and re-parses the
- * package database. Useful after package installation or removal.
+ * Does nothing if neither the index nor pkgdb.json changed. Otherwise the
+ * package commands are dropped and the new index is mapped; commands are
+ * then registered again as they are looked up.
  *
- * @return Number of package commands successfully loaded.
+ * @return 1 if the packages changed, 0 if not, -1 on error.
  */
 int jshell_reload_packages(void) {
+  if (g_index_open && !pkg_index_changed(&g_index)) {
+    return 0;
+  }
+
+  DPRINT("Package database changed, remapping the index");
+  jshell_stats_add(JSHELL_STAT_PKG_RELOADS, 1);
   jshell_unregister_all_package_commands();
-  return jshell_load_installed_packages();
+  if (g_index_open) {
+    pkg_index_close(&g_index);
+    g_index_open = false;
+  }
+  g_index_failed = false;
+
+  if (g_loading_deferred) {
+    jshell_set_command_loader(&g_package_loader);  /* Re-arm listing */
+  }
+  return ensure_index() ? 1 : -1;
 }
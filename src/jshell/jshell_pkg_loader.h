@@ -1,12 +1,15 @@
 #ifndef JSHELL_PKG_LOADER_H
 #define JSHELL_PKG_LOADER_H
 
-// Load installed packages from pkgdb.json and register commands
-// Returns number of packages loaded, or -1 on error
+// Register package commands on first lookup (or listing) from now on
+void jshell_defer_package_loading(void);
+
+// Register every installed package command now
+// Returns number of commands registered, or -1 on error
 int jshell_load_installed_packages(void);
 
-// Reload packages (unregister all, then load fresh)
-// Returns number of packages loaded, or -1 on error
+// Pick up package changes (cheap no-op if the package index is unchanged)
+// Returns 1 if packages changed, 0 if not, or -1 on error
 int jshell_reload_packages(void);
 
 #endif
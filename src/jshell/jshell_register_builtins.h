@@ -7,22 +7,33 @@ void jshell_register_all_builtin_commands(void);
 
 void jshell_register_jobs_command(void);
 void jshell_register_ps_command(void);
+void jshell_register_top_command(void);
+void jshell_register_stats_command(void);
 void jshell_register_kill_command(void);
 void jshell_register_wait_command(void);
+void jshell_register_time_command(void);
+void jshell_register_run_command(void);
+void jshell_register_parallel_command(void);
+void jshell_register_where_command(void);
+void jshell_register_xargs_command(void);
 void jshell_register_edit_replace_line_command(void);
 void jshell_register_edit_insert_line_command(void);
 void jshell_register_edit_delete_line_command(void);
 void jshell_register_edit_replace_command(void);
+void jshell_register_edit_apply_command(void);
 void jshell_register_cd_command(void);
 void jshell_register_pwd_command(void);
 void jshell_register_env_command(void);
 void jshell_register_export_command(void);
 void jshell_register_unset_command(void);
 void jshell_register_type_command(void);
+void jshell_register_hash_command(void);
 void jshell_register_help_command(void);
 void jshell_register_history_command(void);
 void jshell_register_http_get_command(void);
 void jshell_register_http_post_command(void);
+void jshell_register_builtin_sleep_command(void);
+void jshell_register_builtin_date_command(void);
 
 
 #endif
@@ -3,21 +3,172 @@
  * @brief Registration of external (non-builtin) shell commands
  */
 
+#include <limits.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+
 #include "jshell_register_externals.h"
 
+#include "apps/cat/cmd_cat.h"
+#include "apps/compress/cmd_compress.h"
+#include "apps/count/cmd_count.h"
+#include "apps/cp/cmd_cp.h"
+#include "apps/cut/cmd_cut.h"
+#include "apps/date/cmd_date.h"
+#include "apps/diff/cmd_diff.h"
+#include "apps/du/cmd_du.h"
+#include "apps/echo/cmd_echo.h"
+#include "apps/find/cmd_find.h"
+#include "apps/hashsum/cmd_hashsum.h"
+#include "apps/head/cmd_head.h"
+#include "apps/jq/cmd_jq.h"
+#include "apps/ls/cmd_ls.h"
+#include "apps/mkdir/cmd_mkdir.h"
+#include "apps/mv/cmd_mv.h"
 #include "apps/pkg/cmd_pkg.h"
+#include "apps/rg/cmd_rg.h"
+#include "apps/rm/cmd_rm.h"
+#include "apps/rmdir/cmd_rmdir.h"
+#include "apps/sleep/cmd_sleep.h"
+#include "apps/sort/cmd_sort.h"
+#include "apps/stat/cmd_stat.h"
+#include "apps/tail/cmd_tail.h"
+#include "apps/tee/cmd_tee.h"
+#include "apps/touch/cmd_touch.h"
+#include "apps/wc/cmd_wc.h"
+
+
+/**
+ * Apps linked into the jbox binary, busybox style. Each is reachable
+ * through a symlink named after it and runs without a package install.
+ * Interactive apps (less, vi, ftp) stay separate packages: they own the
+ * terminal and gain nothing from running in-process.
+ */
+static const jshell_cmd_spec_t* const LINKED_COMMANDS[] = {
+  &cmd_cat_spec,
+  &cmd_compress_spec,
+  &cmd_count_spec,
+  &cmd_cp_spec,
+  &cmd_cut_spec,
+  &cmd_date_spec,
+  &cmd_diff_spec,
+  &cmd_du_spec,
+  &cmd_echo_spec,
+  &cmd_find_spec,
+  &cmd_hashsum_spec,
+  &cmd_head_spec,
+  &cmd_jq_spec,
+  &cmd_ls_spec,
+  &cmd_mkdir_spec,
+  &cmd_mv_spec,
+  &cmd_rg_spec,
+  &cmd_rm_spec,
+  &cmd_rmdir_spec,
+  &cmd_sleep_spec,
+  &cmd_sort_spec,
+  &cmd_stat_spec,
+  &cmd_tail_spec,
+  &cmd_tee_spec,
+  &cmd_touch_spec,
+  &cmd_wc_spec,
+  NULL
+};
+
+
+/**
+ * Find an app linked into the jbox binary.
+ * @param name Command name, e.g. the basename of argv[0]
+ * @return The app's spec, or NULL if it is not linked in
+ */
+const jshell_cmd_spec_t* jshell_find_linked_command(const char* name) {
+  if (name == NULL) {
+    return NULL;
+  }
+
+  for (size_t i = 0; LINKED_COMMANDS[i] != NULL; i++) {
+    if (strcmp(LINKED_COMMANDS[i]->name, name) == 0) {
+      return LINKED_COMMANDS[i];
+    }
+  }
+  return NULL;
+}
+
+
+/**
+ * Check if a spec belongs to an app linked into the jbox binary.
+ * @param spec Command specification, or NULL
+ * @return true for linked apps, false for anything else (pkg included)
+ */
+bool jshell_is_linked_command(const jshell_cmd_spec_t* spec) {
+  if (spec == NULL) {
+    return false;
+  }
+
+  for (size_t i = 0; LINKED_COMMANDS[i] != NULL; i++) {
+    if (LINKED_COMMANDS[i] == spec) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+/**
+ * Check if a linked app only writes its output through its stream.
+ * cat, head and tee copy data straight to the output descriptor.
+ * @param spec Command specification, or NULL
+ * @return true for linked apps other than those three
+ */
+bool jshell_linked_writes_stream_only(const jshell_cmd_spec_t* spec) {
+  return jshell_is_linked_command(spec)
+         && spec != &cmd_cat_spec
+         && spec != &cmd_head_spec
+         && spec != &cmd_tee_spec;
+}
+
+
+/**
+ * Path of the running jbox binary, resolved once.
+ * Linked apps launched as children exec this path with their own name
+ * as argv[0], which jbox dispatches on.
+ * @return Absolute path, or NULL if /proc/self/exe cannot be read
+ */
+const char* jshell_self_exe_path(void) {
+  static char path[PATH_MAX];
+  static int resolved = 0;
+
+  if (!resolved) {
+    ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (len > 0) {
+      path[len] = '\0';
+      resolved = 1;
+    } else {
+      resolved = -1;
+    }
+  }
+  return (resolved == 1) ? path : NULL;
+}
 
 
 /**
  * Register all external commands with the command registry.
- * Currently only registers the pkg command statically.
- * Other external commands (ls, cat, etc.) are registered dynamically
- * when their packages are installed via "pkg install".
+ * Registers pkg and the apps linked into the jbox binary statically.
+ * The linked apps are registered before packages are loaded, so an
+ * installed package of the same name does not replace them; a builtin
+ * of the same name (sleep, date) replaces the app in the shell, which
+ * keeps the app for its jbox symlink only.
  * This should be called during shell initialization, after builtins.
  */
 void jshell_register_all_external_commands(void) {
-  /* Only register pkg command statically. */
-  /* Other external commands (ls, cat, etc.) are registered dynamically */
-  /* when their packages are installed via "pkg install". */
   jshell_register_pkg_command();
+
+  for (size_t i = 0; LINKED_COMMANDS[i] != NULL; i++) {
+    if (jshell_find_command(LINKED_COMMANDS[i]->name) == NULL) {
+      jshell_register_command(LINKED_COMMANDS[i]);
+    }
+  }
+
+  /* Resolve now, before any thread can ask for it */
+  (void)jshell_self_exe_path();
 }
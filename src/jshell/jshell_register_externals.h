@@ -1,8 +1,31 @@
 #ifndef JSHELL_REGISTER_EXTERNALS_H
 #define JSHELL_REGISTER_EXTERNALS_H
 
+#include <stdbool.h>
+
+#include "jshell_cmd_registry.h"
+
 
 void jshell_register_all_external_commands(void);
 
+// Find an app linked into the jbox binary by command name
+// Used to dispatch on argv[0] when jbox runs through an app's symlink
+// Returns NULL if no such app is linked in
+const jshell_cmd_spec_t* jshell_find_linked_command(const char* name);
+
+// Check if spec belongs to an app linked into the jbox binary
+// These run in-process when their output is not a terminal, and
+// otherwise as a child running this same binary
+bool jshell_is_linked_command(const jshell_cmd_spec_t* spec);
+
+// Check if a linked app writes its output only through its jbox stdout
+// stream, never the descriptor under it (splice, sendfile), so it can be
+// given a stream that has no descriptor
+bool jshell_linked_writes_stream_only(const jshell_cmd_spec_t* spec);
+
+// Path of the running jbox binary, for launching linked apps
+// Returns NULL if it cannot be determined
+const char* jshell_self_exe_path(void);
+
 
 #endif
@@ -0,0 +1,828 @@
+/**
+ * @file jshell_result_cache.c
+ * @brief Output of read-only commands, kept while their inputs are unchanged.
+ *
+ * Inputs are the values of a command's arg_file arguments, found by
+ * parsing argv with the command's own argtable (the way tool schemas are
+ * derived from it), or "." for a run naming none: commands that would read
+ * stdin instead say so through their cache_scope. For each input the
+ * directory holding it is watched, which reports changes to the file and
+ * its replacement by a rename; a named directory is watched itself, and
+ * with CMD_CACHE_TREES so is every directory below it. Watches are shared
+ * between entries and counted: every event bumps its watch's change
+ * counter, and an entry remembers the counters it was recorded at. Events
+ * are read without blocking on each lookup, so a hit costs a few stat()
+ * calls and a copy.
+ *
+ * Watches are added before the command runs and the counters checked
+ * again once it is done, so a file changed while it was being read is
+ * never cached. A forked child (a server connection) must not read the
+ * parent's inotify queue, so it starts over with an empty cache.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "argtable3.h"
+#include "jshell_result_cache.h"
+#include "jshell_cwd.h"
+#include "jshell_stats.h"
+#include "jshell_vars.h"
+#include "utils/jbox_utils.h"
+
+
+/** Directories one entry may watch; larger trees are not cached */
+#define RESULT_CACHE_MAX_WATCHES 1024
+
+/** Largest JSHELL_RESULT_CACHE accepted */
+#define RESULT_CACHE_MAX_SIZE (1024LL * 1024 * 1024)
+
+/** Events that make what a watched directory holds differ */
+#define RESULT_CACHE_EVENTS (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE \
+                             | IN_CREATE | IN_DELETE | IN_MOVED_FROM \
+                             | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+
+/** A watched directory, shared by the entries that depend on it */
+typedef struct {
+  int wd;
+  uint64_t changes;     // Events seen for it
+  size_t refs;
+} CacheWatch;
+
+
+/** What stat() said about an input when the run was recorded */
+typedef struct {
+  bool exists;
+  mode_t mode;
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+  struct timespec ctime;
+} CacheFingerprint;
+
+
+/** Everything a recorded run depends on */
+typedef struct {
+  char** inputs;
+  CacheFingerprint* prints;
+  size_t input_count;
+  int* wds;
+  uint64_t* seen;       // Change counters of wds when recorded
+  size_t wd_count;
+  uint64_t epoch;
+  unsigned long vars_generation;
+} CacheDeps;
+
+
+struct JShellResultFill {
+  char* key;
+  size_t key_len;
+  CacheDeps deps;
+};
+
+
+typedef struct CacheEntry {
+  char* key;            // Working directory and argv, NUL-separated
+  size_t key_len;
+  char* output;
+  size_t len;
+  int status;
+  CacheDeps deps;
+  struct CacheEntry* prev;   // Most recently used first
+  struct CacheEntry* next;
+} CacheEntry;
+
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static int g_inotify_fd = -1;
+static bool g_initialized = false;
+static uint64_t g_epoch = 0;             // Bumped when events were lost
+static CacheWatch* g_watches = NULL;     // Sorted by wd
+static size_t g_watch_count = 0;
+static size_t g_watch_cap = 0;
+static CacheEntry* g_head = NULL;
+static CacheEntry* g_tail = NULL;
+static size_t g_bytes = 0;               // Output held by all entries
+static arg_scanfn* g_file_scanfn = NULL;
+
+
+size_t jshell_result_cache_size(void) {
+  const char* value = jshell_var_get("JSHELL_RESULT_CACHE");
+  if (value == NULL || *value == '\0') {
+    return 0;
+  }
+
+  char* end;
+  long long size = strtoll(value, &end, 10);
+  if (*end == 'k' || *end == 'K') {
+    size *= 1024;
+    end++;
+  } else if (*end == 'm' || *end == 'M') {
+    size *= 1024 * 1024;
+    end++;
+  }
+  if (*end != '\0' || size < 0 || size > RESULT_CACHE_MAX_SIZE) {
+    fprintf(stderr, "jshell: ignoring invalid JSHELL_RESULT_CACHE '%s'\n",
+            value);
+    return 0;
+  }
+  return (size_t)size;
+}
+
+
+/**
+ * Find a watch by descriptor. Caller holds g_lock.
+ * @param wd Watch descriptor.
+ * @return The watch, or NULL.
+ */
+static CacheWatch* watch_find(int wd) {
+  size_t lo = 0;
+  size_t hi = g_watch_count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (g_watches[mid].wd == wd) {
+      return &g_watches[mid];
+    }
+    if (g_watches[mid].wd < wd) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return NULL;
+}
+
+
+/**
+ * Watch a directory, or take another reference to its watch.
+ * Caller holds g_lock.
+ * @param path Directory to watch.
+ * @return Watch descriptor, or -1 if it cannot be watched.
+ */
+static int watch_acquire(const char* path) {
+  int wd = inotify_add_watch(g_inotify_fd, path,
+                             RESULT_CACHE_EVENTS | IN_ONLYDIR);
+  if (wd == -1) {
+    DPRINT("Result cache cannot watch %s: %s", path, strerror(errno));
+    return -1;
+  }
+
+  CacheWatch* watch = watch_find(wd);
+  if (watch != NULL) {
+    watch->refs++;
+    return wd;
+  }
+
+  if (g_watch_count == g_watch_cap) {
+    size_t cap = g_watch_cap > 0 ? g_watch_cap * 2 : 64;
+    CacheWatch* grown = realloc(g_watches, cap * sizeof(CacheWatch));
+    if (grown == NULL) {
+      inotify_rm_watch(g_inotify_fd, wd);
+      return -1;
+    }
+    g_watches = grown;
+    g_watch_cap = cap;
+  }
+  size_t pos = g_watch_count;
+  while (pos > 0 && g_watches[pos - 1].wd > wd) {
+    g_watches[pos] = g_watches[pos - 1];
+    pos--;
+  }
+  g_watches[pos] = (CacheWatch){ .wd = wd, .changes = 0, .refs = 1 };
+  g_watch_count++;
+  return wd;
+}
+
+
+/**
+ * Drop a reference to a watch, removing it with the last one.
+ * Caller holds g_lock.
+ * @param wd Watch descriptor from watch_acquire().
+ */
+static void watch_release(int wd) {
+  CacheWatch* watch = watch_find(wd);
+  if (watch == NULL || --watch->refs > 0) {
+    return;
+  }
+  inotify_rm_watch(g_inotify_fd, wd);
+  size_t pos = (size_t)(watch - g_watches);
+  memmove(&g_watches[pos], &g_watches[pos + 1],
+          (g_watch_count - pos - 1) * sizeof(CacheWatch));
+  g_watch_count--;
+}
+
+
+/**
+ * Read the events queued so far and count them against their watches.
+ * Caller holds g_lock.
+ */
+static void drain_events(void) {
+  if (g_inotify_fd < 0) {
+    return;
+  }
+  char buf[4096]
+    __attribute__((aligned(__alignof__(struct inotify_event))));
+  for (;;) {
+    ssize_t n = read(g_inotify_fd, buf, sizeof(buf));
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return;
+    }
+    for (char* p = buf; p < buf + n;) {
+      const struct inotify_event* event = (const struct inotify_event*)p;
+      if (event->mask & IN_Q_OVERFLOW) {
+        g_epoch++;
+      } else {
+        CacheWatch* watch = watch_find(event->wd);
+        if (watch != NULL) {
+          watch->changes++;
+        }
+      }
+      p += sizeof(struct inotify_event) + event->len;
+    }
+  }
+}
+
+
+/**
+ * Free what a set of dependencies holds and release its watches.
+ * Caller holds g_lock.
+ * @param deps Dependencies to free.
+ */
+static void deps_free(CacheDeps* deps) {
+  for (size_t i = 0; i < deps->input_count; i++) {
+    free(deps->inputs[i]);
+  }
+  for (size_t i = 0; i < deps->wd_count; i++) {
+    watch_release(deps->wds[i]);
+  }
+  free(deps->inputs);
+  free(deps->prints);
+  free(deps->wds);
+  free(deps->seen);
+  memset(deps, 0, sizeof(*deps));
+}
+
+
+/**
+ * Unlink an entry and free it. Caller holds g_lock.
+ * @param entry Entry in the list.
+ */
+static void entry_remove(CacheEntry* entry) {
+  if (entry->prev != NULL) {
+    entry->prev->next = entry->next;
+  } else {
+    g_head = entry->next;
+  }
+  if (entry->next != NULL) {
+    entry->next->prev = entry->prev;
+  } else {
+    g_tail = entry->prev;
+  }
+  g_bytes -= entry->len;
+  deps_free(&entry->deps);
+  free(entry->key);
+  free(entry->output);
+  free(entry);
+}
+
+
+/**
+ * In a forked child: the inotify queue is shared with the parent, so
+ * close it and forget everything that depended on it.
+ */
+static void result_cache_after_fork(void) {
+  pthread_mutex_init(&g_lock, NULL);
+  if (g_inotify_fd >= 0) {
+    close(g_inotify_fd);
+    g_inotify_fd = -1;
+  }
+  while (g_head != NULL) {
+    entry_remove(g_head);
+  }
+  free(g_watches);
+  g_watches = NULL;
+  g_watch_count = 0;
+  g_watch_cap = 0;
+  g_initialized = false;
+}
+
+
+/**
+ * Open the inotify queue and learn arg_file's scan function, once.
+ * Caller holds g_lock.
+ */
+static void result_cache_init(void) {
+  static bool atfork_registered = false;
+
+  if (g_initialized) {
+    return;
+  }
+  g_initialized = true;
+  if (!atfork_registered) {
+    pthread_atfork(NULL, NULL, result_cache_after_fork);
+    atfork_registered = true;
+  }
+
+  g_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (g_inotify_fd == -1) {
+    DPRINT("Result cache without inotify: %s", strerror(errno));
+  }
+
+  if (g_file_scanfn == NULL) {
+    void* probe[] = { arg_file0(NULL, NULL, NULL, NULL) };
+    if (probe[0] != NULL) {
+      g_file_scanfn = ((struct arg_hdr*)probe[0])->scanfn;
+    }
+    arg_freetable(probe, 1);
+  }
+}
+
+
+/**
+ * Build the key of a run: working directory and argv, NUL-separated.
+ * @param argc Argument count.
+ * @param argv Arguments.
+ * @param key_len Set to the key's length.
+ * @return Allocated key, or NULL.
+ */
+static char* build_key(int argc, char** argv, size_t* key_len) {
+  char cwd[PATH_MAX];
+  if (jshell_cwd_path(cwd, sizeof(cwd)) == NULL) {
+    return NULL;
+  }
+  size_t len = strlen(cwd) + 1;
+  for (int i = 0; i < argc; i++) {
+    len += strlen(argv[i]) + 1;
+  }
+
+  char* key = malloc(len);
+  if (key == NULL) {
+    return NULL;
+  }
+  char* p = stpcpy(key, cwd) + 1;
+  for (int i = 0; i < argc; i++) {
+    p = stpcpy(p, argv[i]) + 1;
+  }
+  *key_len = len;
+  return key;
+}
+
+
+/**
+ * Find the entry of a key. Caller holds g_lock.
+ * @param key Key from build_key().
+ * @param key_len Its length.
+ * @return The entry, or NULL.
+ */
+static CacheEntry* entry_find(const char* key, size_t key_len) {
+  for (CacheEntry* entry = g_head; entry != NULL; entry = entry->next) {
+    if (entry->key_len == key_len && memcmp(entry->key, key, key_len) == 0) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+
+/**
+ * Take a fingerprint of an input.
+ * @param path Input path.
+ * @param print Filled in; exists is false if stat() fails.
+ */
+static void take_fingerprint(const char* path, CacheFingerprint* print) {
+  struct stat st;
+  memset(print, 0, sizeof(*print));
+  if (stat(path, &st) != 0) {
+    return;
+  }
+  print->exists = true;
+  print->mode = st.st_mode;
+  print->dev = st.st_dev;
+  print->ino = st.st_ino;
+  print->size = st.st_size;
+  print->mtime = st.st_mtim;
+  print->ctime = st.st_ctim;
+}
+
+
+/**
+ * Compare two fingerprints.
+ * @return true if they describe the same, unchanged file.
+ */
+static bool same_fingerprint(const CacheFingerprint* a,
+                             const CacheFingerprint* b) {
+  if (a->exists != b->exists) {
+    return false;
+  }
+  return !a->exists
+         || (a->mode == b->mode && a->dev == b->dev && a->ino == b->ino
+             && a->size == b->size
+             && a->mtime.tv_sec == b->mtime.tv_sec
+             && a->mtime.tv_nsec == b->mtime.tv_nsec
+             && a->ctime.tv_sec == b->ctime.tv_sec
+             && a->ctime.tv_nsec == b->ctime.tv_nsec);
+}
+
+
+/**
+ * Check that nothing a run depends on changed. Caller holds g_lock and
+ * has drained the events.
+ * @param deps Dependencies of the run.
+ * @return true if its output is still valid.
+ */
+static bool deps_valid(const CacheDeps* deps) {
+  if (deps->epoch != g_epoch
+      || deps->vars_generation != jshell_vars_generation()) {
+    return false;
+  }
+  for (size_t i = 0; i < deps->wd_count; i++) {
+    const CacheWatch* watch = watch_find(deps->wds[i]);
+    if (watch == NULL || watch->changes != deps->seen[i]) {
+      return false;
+    }
+  }
+  for (size_t i = 0; i < deps->input_count; i++) {
+    CacheFingerprint now;
+    take_fingerprint(deps->inputs[i], &now);
+    if (!same_fingerprint(&now, &deps->prints[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+/**
+ * Add a directory to the watches of a run, once.
+ * Caller holds g_lock.
+ * @param deps Dependencies of the run.
+ * @param path Directory.
+ * @return 0 on success, -1 if it cannot be watched or too many are.
+ */
+static int deps_watch(CacheDeps* deps, const char* path) {
+  if (deps->wd_count == RESULT_CACHE_MAX_WATCHES) {
+    return -1;
+  }
+  int wd = watch_acquire(path);
+  if (wd == -1) {
+    return -1;
+  }
+  for (size_t i = 0; i < deps->wd_count; i++) {
+    if (deps->wds[i] == wd) {
+      watch_release(wd);
+      return 0;
+    }
+  }
+  deps->wds[deps->wd_count++] = wd;
+  return 0;
+}
+
+
+/**
+ * Watch every directory below a directory, without following symlinks.
+ * Caller holds g_lock.
+ * @param deps Dependencies of the run.
+ * @param path Directory, already watched.
+ * @return 0 on success, -1 if the tree cannot be watched in full.
+ */
+static int deps_watch_tree(CacheDeps* deps, const char* path) {
+  DIR* dir = opendir(path);
+  if (dir == NULL) {
+    return -1;
+  }
+  int result = 0;
+  struct dirent* ent;
+  while (result == 0 && (ent = readdir(dir)) != NULL) {
+    if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+      continue;
+    }
+    char child[PATH_MAX];
+    if (snprintf(child, sizeof(child), "%s/%s", path, ent->d_name)
+        >= (int)sizeof(child)) {
+      result = -1;
+      break;
+    }
+    bool is_dir = ent->d_type == DT_DIR;
+    if (ent->d_type == DT_UNKNOWN) {
+      struct stat st;
+      is_dir = lstat(child, &st) == 0 && S_ISDIR(st.st_mode);
+    }
+    if (is_dir) {
+      result = deps_watch(deps, child) == 0 ? deps_watch_tree(deps, child)
+                                            : -1;
+    }
+  }
+  closedir(dir);
+  return result;
+}
+
+
+/** Inputs of a run, gathered while its argtable is alive */
+typedef struct {
+  int argc;
+  char** argv;
+  char** inputs;
+  size_t count;
+  bool ok;
+} InputScan;
+
+
+/**
+ * Parse argv with a command's argtable and collect its arg_file values.
+ * @param argtable The command's table.
+ * @param userdata The InputScan.
+ */
+static void scan_inputs(void** argtable, void* userdata) {
+  InputScan* scan = userdata;
+  if (arg_parse(scan->argc, scan->argv, argtable) > 0) {
+    scan->ok = false;
+    return;
+  }
+
+  size_t total = 0;
+  for (size_t i = 0; !(((struct arg_hdr*)argtable[i])->flag
+                       & ARG_TERMINATOR); i++) {
+    const struct arg_hdr* hdr = argtable[i];
+    if (hdr->scanfn == g_file_scanfn) {
+      total += (size_t)((struct arg_file*)argtable[i])->count;
+    }
+  }
+  scan->inputs = calloc(total > 0 ? total : 1, sizeof(char*));
+  if (scan->inputs == NULL) {
+    scan->ok = false;
+    return;
+  }
+  if (total == 0) {
+    scan->inputs[0] = strdup(".");
+    scan->count = scan->inputs[0] != NULL ? 1 : 0;
+    scan->ok = scan->count == 1;
+    return;
+  }
+
+  for (size_t i = 0; !(((struct arg_hdr*)argtable[i])->flag
+                       & ARG_TERMINATOR); i++) {
+    const struct arg_hdr* hdr = argtable[i];
+    if (hdr->scanfn != g_file_scanfn) {
+      continue;
+    }
+    const struct arg_file* file = argtable[i];
+    for (int j = 0; j < file->count; j++) {
+      if (strcmp(file->filename[j], "-") == 0) {
+        scan->ok = false;  /* Standard input */
+        return;
+      }
+      scan->inputs[scan->count] = strdup(file->filename[j]);
+      if (scan->inputs[scan->count] == NULL) {
+        scan->ok = false;
+        return;
+      }
+      scan->count++;
+    }
+  }
+}
+
+
+/**
+ * Resolve, fingerprint and watch the inputs of a run.
+ * Caller holds g_lock.
+ * @param deps Filled in; freed by the caller on failure too.
+ * @param scope How the output depends on the inputs.
+ * @return 0 on success, -1 if the run cannot be cached.
+ */
+static int deps_record(CacheDeps* deps, jshell_cmd_cache_t scope) {
+  deps->prints = calloc(deps->input_count, sizeof(CacheFingerprint));
+  deps->wds = calloc(RESULT_CACHE_MAX_WATCHES, sizeof(int));
+  if (deps->prints == NULL || deps->wds == NULL) {
+    return -1;
+  }
+
+  for (size_t i = 0; i < deps->input_count; i++) {
+    const char* input = deps->inputs[i];
+    CacheFingerprint* print = &deps->prints[i];
+    take_fingerprint(input, print);
+    bool is_dir = print->exists && S_ISDIR(print->mode);
+
+    if (g_inotify_fd < 0) {
+      /* The fingerprint is all there is: it misses changes inside a
+       * directory, and below one */
+      if (scope != CMD_CACHE_FILES || !print->exists
+          || !S_ISREG(print->mode)) {
+        return -1;
+      }
+      continue;
+    }
+
+    char parent[PATH_MAX];
+    const char* slash = strrchr(input, '/');
+    if (slash == NULL) {
+      strcpy(parent, ".");
+    } else if (slash == input) {
+      strcpy(parent, "/");
+    } else if ((size_t)(slash - input) < sizeof(parent)) {
+      memcpy(parent, input, (size_t)(slash - input));
+      parent[slash - input] = '\0';
+    } else {
+      return -1;
+    }
+    if (deps_watch(deps, parent) != 0) {
+      return -1;
+    }
+    if (is_dir) {
+      if (deps_watch(deps, input) != 0) {
+        return -1;
+      }
+      if (scope == CMD_CACHE_TREES && deps_watch_tree(deps, input) != 0) {
+        return -1;
+      }
+    }
+  }
+
+  deps->seen = calloc(deps->wd_count > 0 ? deps->wd_count : 1,
+                      sizeof(uint64_t));
+  if (deps->seen == NULL) {
+    return -1;
+  }
+  drain_events();
+  for (size_t i = 0; i < deps->wd_count; i++) {
+    deps->seen[i] = watch_find(deps->wds[i])->changes;
+  }
+  deps->epoch = g_epoch;
+  deps->vars_generation = jshell_vars_generation();
+  return 0;
+}
+
+
+bool jshell_result_cache_lookup(const jshell_cmd_spec_t* spec, int argc,
+                                char** argv, char** output, size_t* len,
+                                int* status) {
+  (void)spec;
+  pthread_mutex_lock(&g_lock);
+  if (g_head == NULL) {
+    pthread_mutex_unlock(&g_lock);
+    return false;
+  }
+
+  size_t key_len;
+  char* key = build_key(argc, argv, &key_len);
+  CacheEntry* entry = key != NULL ? entry_find(key, key_len) : NULL;
+  free(key);
+  if (entry == NULL) {
+    pthread_mutex_unlock(&g_lock);
+    return false;
+  }
+
+  drain_events();
+  if (!deps_valid(&entry->deps)) {
+    DPRINT("Result cache entry for %s went stale", argv[0]);
+    entry_remove(entry);
+    pthread_mutex_unlock(&g_lock);
+    return false;
+  }
+
+  char* copy = malloc(entry->len + 1);
+  if (copy == NULL) {
+    pthread_mutex_unlock(&g_lock);
+    return false;
+  }
+  memcpy(copy, entry->output, entry->len);
+  copy[entry->len] = '\0';
+  *output = copy;
+  *len = entry->len;
+  *status = entry->status;
+
+  if (entry != g_head) {
+    entry->prev->next = entry->next;
+    if (entry->next != NULL) {
+      entry->next->prev = entry->prev;
+    } else {
+      g_tail = entry->prev;
+    }
+    entry->prev = NULL;
+    entry->next = g_head;
+    g_head->prev = entry;
+    g_head = entry;
+  }
+  pthread_mutex_unlock(&g_lock);
+
+  jshell_stats_add(JSHELL_STAT_RESULT_HITS, 1);
+  return true;
+}
+
+
+JShellResultFill* jshell_result_cache_begin(const jshell_cmd_spec_t* spec,
+                                            int argc, char** argv) {
+  if (spec->cache_scope == NULL || spec->describe_args == NULL) {
+    return NULL;
+  }
+  jshell_cmd_cache_t scope = spec->cache_scope(argc, argv);
+  if (scope == CMD_CACHE_NONE) {
+    return NULL;
+  }
+
+  JShellResultFill* fill = calloc(1, sizeof(JShellResultFill));
+  if (fill == NULL) {
+    return NULL;
+  }
+  fill->key = build_key(argc, argv, &fill->key_len);
+
+  pthread_mutex_lock(&g_lock);
+  result_cache_init();
+
+  InputScan scan = { .argc = argc, .argv = argv, .ok = true };
+  if (fill->key != NULL && g_file_scanfn != NULL) {
+    spec->describe_args(scan_inputs, &scan);
+  }
+  fill->deps.inputs = scan.inputs;
+  fill->deps.input_count = scan.count;
+
+  if (fill->key == NULL || !scan.ok || scan.count == 0
+      || deps_record(&fill->deps, scope) != 0) {
+    DPRINT("Run of %s is not cacheable", argv[0]);
+    deps_free(&fill->deps);
+    pthread_mutex_unlock(&g_lock);
+    free(fill->key);
+    free(fill);
+    return NULL;
+  }
+  pthread_mutex_unlock(&g_lock);
+
+  jshell_stats_add(JSHELL_STAT_RESULT_MISSES, 1);
+  return fill;
+}
+
+
+void jshell_result_cache_commit(JShellResultFill* fill, const char* output,
+                                size_t len, int status) {
+  if (fill == NULL) {
+    return;
+  }
+  size_t limit = jshell_result_cache_size();
+
+  pthread_mutex_lock(&g_lock);
+  drain_events();
+  CacheEntry* entry = NULL;
+  if (status == 0 && len <= limit && deps_valid(&fill->deps)) {
+    entry = calloc(1, sizeof(CacheEntry));
+  }
+  char* copy = entry != NULL ? malloc(len > 0 ? len : 1) : NULL;
+  if (copy == NULL) {
+    free(entry);
+    deps_free(&fill->deps);
+    pthread_mutex_unlock(&g_lock);
+    free(fill->key);
+    free(fill);
+    return;
+  }
+  memcpy(copy, output, len);
+
+  CacheEntry* old = entry_find(fill->key, fill->key_len);
+  if (old != NULL) {
+    entry_remove(old);
+  }
+  while (g_tail != NULL && g_bytes + len > limit) {
+    entry_remove(g_tail);
+  }
+
+  entry->key = fill->key;
+  entry->key_len = fill->key_len;
+  entry->output = copy;
+  entry->len = len;
+  entry->status = status;
+  entry->deps = fill->deps;
+  entry->next = g_head;
+  if (g_head != NULL) {
+    g_head->prev = entry;
+  } else {
+    g_tail = entry;
+  }
+  g_head = entry;
+  g_bytes += len;
+  pthread_mutex_unlock(&g_lock);
+
+  free(fill);
+}
+
+
+void jshell_result_cache_clear(void) {
+  pthread_mutex_lock(&g_lock);
+  while (g_head != NULL) {
+    entry_remove(g_head);
+  }
+  pthread_mutex_unlock(&g_lock);
+}
@@ -0,0 +1,55 @@
+#ifndef JSHELL_RESULT_CACHE_H
+#define JSHELL_RESULT_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "jshell_cmd_registry.h"
+
+
+// Opt-in cache of the output of read-only commands, for agents that run
+// the same `ls --json dir`, `stat` or `rg` again and again between edits
+//
+// Commands whose spec has a cache_scope qualify when they run in the
+// shell as a single foreground command. A run is keyed by the working
+// directory and argv, and its inputs are the files named by its arg_file
+// arguments, or the working directory if it names none. Before the
+// command reads them, the directories holding them (and, per the scope,
+// the directories below them) are watched with inotify; the output is
+// served again while no event arrived for any of them, their inode, size,
+// mtime and ctime are unchanged and no shell variable changed. Without
+// inotify only regular files named directly are cached, validated by
+// their fingerprint alone.
+
+
+// A run whose output is being recorded
+typedef struct JShellResultFill JShellResultFill;
+
+
+// Bytes of output kept, from the JSHELL_RESULT_CACHE variable (bytes, or
+// with a K/M suffix); 0, the default, disables the cache
+size_t jshell_result_cache_size(void);
+
+// Look up a run of spec with argv
+// On a hit sets *output (NUL-terminated, caller frees), *len and *status
+// Returns false on a miss or if the entry went stale
+bool jshell_result_cache_lookup(const jshell_cmd_spec_t* spec, int argc,
+                                char** argv, char** output, size_t* len,
+                                int* status);
+
+// Start recording a run: resolves the inputs and watches them before the
+// command reads them
+// Returns NULL if this run cannot be cached
+JShellResultFill* jshell_result_cache_begin(const jshell_cmd_spec_t* spec,
+                                            int argc, char** argv);
+
+// Finish recording and free fill; the output is kept if status is 0 and
+// no input changed while the command ran
+void jshell_result_cache_commit(JShellResultFill* fill, const char* output,
+                                size_t len, int status);
+
+// Drop every entry and watch
+void jshell_result_cache_clear(void);
+
+
+#endif
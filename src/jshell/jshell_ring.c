@@ -0,0 +1,341 @@
+/**
+ * @file jshell_ring.c
+ * @brief Shared-memory byte rings between in-process pipeline stages.
+ *
+ * Two builtins next to each other in a pipeline run on threads of the
+ * shell, so the data between them need not go through the kernel. A ring
+ * has one producer and one consumer: each side owns its position, reads
+ * the other's with acquire loads and copies with memcpy. A side that finds
+ * the ring empty (or full) sleeps on a futex word the other side bumps
+ * after every transfer, and the other side only makes the wake-up system
+ * call when it sees a sleeper flag set.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <linux/futex.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "jshell_ring.h"
+#include "utils/jbox_utils.h"
+
+
+/** Largest ring; positions wrap at 2^32, so it must stay below 2^31 */
+#define RING_MAX_SIZE (1024u * 1024 * 1024)
+
+/** Cache line size, to keep the two sides' fields apart */
+#define RING_CACHE_LINE 64
+
+/** Polls of the futex word before sleeping on it */
+#define RING_SPIN_LOOPS 4000
+
+
+/**
+ * Ring state. Positions count bytes since creation, modulo 2^32; the
+ * fill level is head - tail.
+ */
+struct JShellRing {
+  /* Written by the producer */
+  alignas(RING_CACHE_LINE) _Atomic uint32_t head;
+  _Atomic uint32_t data_seq;      /* Futex: bumped on each write and close */
+  atomic_bool writer_closed;
+  atomic_bool writer_waiting;     /* Producer asleep on space_seq */
+
+  /* Written by the consumer */
+  alignas(RING_CACHE_LINE) _Atomic uint32_t tail;
+  _Atomic uint32_t space_seq;     /* Futex: bumped on each read and close */
+  atomic_bool reader_closed;
+  atomic_bool reader_waiting;     /* Consumer asleep on data_seq */
+
+  alignas(RING_CACHE_LINE) atomic_int ends;   /* Ends still open */
+  uint32_t size;
+  int spin;                       /* Polls before sleeping; 0 on one CPU */
+  const atomic_bool* read_cancel; /* Fails reads once set, or NULL */
+  char* data;
+};
+
+
+/**
+ * Sleep until *word no longer holds seen.
+ * @param ring The ring.
+ * @param word Futex word.
+ * @param seen Value read before deciding to sleep.
+ * @param waiting Flag telling the other side to wake us.
+ * @param timeout Longest sleep, or NULL to wait for the other side.
+ */
+static void ring_sleep(const JShellRing* ring, _Atomic uint32_t* word,
+                       uint32_t seen, atomic_bool* waiting,
+                       const struct timespec* timeout) {
+  /* With another CPU, the other side is usually busy copying: catching
+   * its next transfer by polling saves both a sleep and a wake-up call */
+  for (int i = 0; i < ring->spin; i++) {
+    if (atomic_load_explicit(word, memory_order_relaxed) != seen) {
+      return;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+  }
+
+  atomic_store(waiting, true);
+  /* Returns at once if the other side bumped the word since seen */
+  syscall(SYS_futex, (uint32_t*)word, FUTEX_WAIT_PRIVATE, seen, timeout,
+          NULL, 0);
+  atomic_store(waiting, false);
+}
+
+
+/**
+ * Bump a futex word and wake the other side if it sleeps on it.
+ * @param word Futex word.
+ * @param waiting The other side's sleeper flag.
+ * @param wake Whether a sleeper should be woken now; if not, a later
+ *        notify must wake it.
+ */
+static void ring_notify(_Atomic uint32_t* word, atomic_bool* waiting,
+                        bool wake) {
+  atomic_fetch_add(word, 1);
+  if (wake && atomic_load(waiting)) {
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAKE_PRIVATE, 1, NULL,
+            NULL, 0);
+  }
+}
+
+
+/**
+ * Drop one end of a ring, freeing it with the last one.
+ * @param ring The ring.
+ */
+static void ring_release(JShellRing* ring) {
+  if (atomic_fetch_sub(&ring->ends, 1) == 1) {
+    free(ring->data);
+    free(ring);
+  }
+}
+
+
+/**
+ * Create a ring.
+ * @param capacity Wanted capacity in bytes.
+ * @return New ring with both ends open, or NULL on failure.
+ */
+JShellRing* jshell_ring_create(size_t capacity) {
+  size_t size = JSHELL_RING_MIN_SIZE;
+  while (size < capacity && size < RING_MAX_SIZE) {
+    size *= 2;
+  }
+
+  JShellRing* ring = aligned_alloc(RING_CACHE_LINE, sizeof(JShellRing));
+  if (ring == NULL) {
+    perror("jshell: ring");
+    return NULL;
+  }
+  memset(ring, 0, sizeof(*ring));
+
+  ring->data = malloc(size);
+  if (ring->data == NULL) {
+    perror("jshell: ring");
+    free(ring);
+    return NULL;
+  }
+  ring->size = (uint32_t)size;
+  ring->spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? RING_SPIN_LOOPS : 0;
+  atomic_init(&ring->ends, 2);
+
+  DPRINT("Created ring of %zu bytes", size);
+  return ring;
+}
+
+
+/**
+ * Copy bytes out of a ring, waiting while it is empty.
+ * @param cookie The ring.
+ * @param buf Destination.
+ * @param len Room in buf.
+ * @return Bytes read, 0 at end of data, or -1 (errno ECANCELED) once the
+ *         reader is cancelled and no data is left.
+ */
+static ssize_t ring_read(void* cookie, char* buf, size_t len) {
+  static const struct timespec cancel_poll = {
+    .tv_nsec = JSHELL_RING_CANCEL_POLL_MS * 1000000L
+  };
+  JShellRing* ring = cookie;
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+  while (true) {
+    uint32_t seq = atomic_load(&ring->data_seq);
+    bool closed = atomic_load(&ring->writer_closed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint32_t avail = head - tail;
+
+    if (avail > 0) {
+      size_t count = len < avail ? len : avail;
+      size_t offset = tail & (ring->size - 1);
+      size_t first = ring->size - offset;
+      if (first > count) {
+        first = count;
+      }
+      memcpy(buf, ring->data + offset, first);
+      memcpy(buf + first, ring->data, count - first);
+
+      tail += (uint32_t)count;
+      atomic_store_explicit(&ring->tail, tail, memory_order_release);
+      /* A full ring's writer is woken once half of it is free, not for
+       * every read, so it refills in large copies */
+      ring_notify(&ring->space_seq, &ring->writer_waiting,
+                  ring->size - (head - tail) >= ring->size / 2);
+      return (ssize_t)count;
+    }
+    if (closed) {
+      return 0;
+    }
+    if (ring->read_cancel != NULL) {
+      if (atomic_load(ring->read_cancel)) {
+        errno = ECANCELED;
+        return -1;
+      }
+      /* Nothing wakes us on cancellation: look again now and then */
+      ring_sleep(ring, &ring->data_seq, seq, &ring->reader_waiting,
+                 &cancel_poll);
+      continue;
+    }
+    ring_sleep(ring, &ring->data_seq, seq, &ring->reader_waiting, NULL);
+  }
+}
+
+
+/**
+ * Copy bytes into a ring, waiting while it is full.
+ * @param cookie The ring.
+ * @param buf Bytes to write.
+ * @param len Number of bytes.
+ * @return Bytes written; short (errno EPIPE) once the reader has gone.
+ */
+static ssize_t ring_write(void* cookie, const char* buf, size_t len) {
+  JShellRing* ring = cookie;
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  size_t done = 0;
+
+  while (done < len) {
+    uint32_t seq = atomic_load(&ring->space_seq);
+    if (atomic_load(&ring->reader_closed)) {
+      errno = EPIPE;
+      break;
+    }
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    uint32_t space = ring->size - (head - tail);
+
+    if (space == 0) {
+      ring_sleep(ring, &ring->space_seq, seq, &ring->writer_waiting, NULL);
+      continue;
+    }
+
+    size_t count = len - done < space ? len - done : space;
+    size_t offset = head & (ring->size - 1);
+    size_t first = ring->size - offset;
+    if (first > count) {
+      first = count;
+    }
+    memcpy(ring->data + offset, buf + done, first);
+    memcpy(ring->data, buf + done + first, count - first);
+
+    head += (uint32_t)count;
+    atomic_store_explicit(&ring->head, head, memory_order_release);
+    ring_notify(&ring->data_seq, &ring->reader_waiting, true);
+    done += count;
+  }
+  return (ssize_t)done;
+}
+
+
+/**
+ * Make reads of a ring fail once a cancel flag is set.
+ * @param ring The ring.
+ * @param cancel Flag checked by the reader.
+ */
+void jshell_ring_cancel_reads_on(JShellRing* ring,
+                                 const atomic_bool* cancel) {
+  ring->read_cancel = cancel;
+}
+
+
+/**
+ * Close the read end of a ring.
+ * @param ring The ring.
+ */
+void jshell_ring_close_reader(JShellRing* ring) {
+  atomic_store(&ring->reader_closed, true);
+  ring_notify(&ring->space_seq, &ring->writer_waiting, true);
+  ring_release(ring);
+}
+
+
+/**
+ * Close the write end of a ring.
+ * @param ring The ring.
+ */
+void jshell_ring_close_writer(JShellRing* ring) {
+  atomic_store(&ring->writer_closed, true);
+  ring_notify(&ring->data_seq, &ring->reader_waiting, true);
+  ring_release(ring);
+}
+
+
+/**
+ * Stream close callback for the read end.
+ * @param cookie The ring.
+ * @return 0.
+ */
+static int ring_close_reader_stream(void* cookie) {
+  jshell_ring_close_reader(cookie);
+  return 0;
+}
+
+
+/**
+ * Stream close callback for the write end.
+ * @param cookie The ring.
+ * @return 0.
+ */
+static int ring_close_writer_stream(void* cookie) {
+  jshell_ring_close_writer(cookie);
+  return 0;
+}
+
+
+/**
+ * Open the read end of a ring as a stream.
+ * @param ring The ring.
+ * @return Stream, or NULL on failure.
+ */
+FILE* jshell_ring_open_reader(JShellRing* ring) {
+  cookie_io_functions_t funcs = {
+    .read = ring_read,
+    .close = ring_close_reader_stream,
+  };
+  return fopencookie(ring, "r", funcs);
+}
+
+
+/**
+ * Open the write end of a ring as a stream.
+ * @param ring The ring.
+ * @return Stream, or NULL on failure.
+ */
+FILE* jshell_ring_open_writer(JShellRing* ring) {
+  cookie_io_functions_t funcs = {
+    .write = ring_write,
+    .close = ring_close_writer_stream,
+  };
+  return fopencookie(ring, "w", funcs);
+}
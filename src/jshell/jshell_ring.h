@@ -0,0 +1,49 @@
+#ifndef JSHELL_RING_H
+#define JSHELL_RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+
+
+// Smallest ring capacity, used when pipes keep the kernel default size
+#define JSHELL_RING_MIN_SIZE (64 * 1024)
+
+// How often a reader waiting for data checks its cancel flag
+#define JSHELL_RING_CANCEL_POLL_MS 50
+
+// Single-producer/single-consumer byte ring between two threads of the
+// shell, carrying the data of a pipe between neighbouring builtin stages
+// without system calls; each side blocks on a futex only when the ring
+// is empty or full
+typedef struct JShellRing JShellRing;
+
+
+// Create a ring holding at least capacity bytes (rounded up to a power of
+// two, at least JSHELL_RING_MIN_SIZE)
+// Returns NULL on failure
+JShellRing* jshell_ring_create(size_t capacity);
+
+// Open the read end of a ring as a stream; reads block until data is
+// written, and return EOF once the write end is closed and the ring drained
+// Closing the stream closes the read end, after which writes fail with
+// EPIPE; returns NULL on failure (the read end stays open)
+FILE* jshell_ring_open_reader(JShellRing* ring);
+
+// Open the write end of a ring as a stream; writes block while the ring
+// is full; closing the stream closes the write end
+// Returns NULL on failure (the write end stays open)
+FILE* jshell_ring_open_writer(JShellRing* ring);
+
+// Make reads fail with ECANCELED once *cancel is set, including a read
+// already waiting for data (which notices within JSHELL_RING_CANCEL_POLL_MS)
+// Call before opening the read end; cancel must outlive the reader
+void jshell_ring_cancel_reads_on(JShellRing* ring, const atomic_bool* cancel);
+
+// Close the read or write end of a ring that was never opened as a
+// stream; the ring is freed once both ends are closed
+void jshell_ring_close_reader(JShellRing* ring);
+void jshell_ring_close_writer(JShellRing* ring);
+
+
+#endif
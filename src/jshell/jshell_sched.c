@@ -0,0 +1,311 @@
+/**
+ * @file jshell_sched.c
+ * @brief CPU affinity, nice value and cgroup placement of jobs.
+ *
+ * A job written as `run --cpus 4-7 --nice 10 make` keeps its processes
+ * off the cores and out of the way of interactive commands. Children are
+ * launched with posix_spawn(), which cannot run code in the child, so the
+ * placement is applied from the shell right after each child starts:
+ * sched_setaffinity() and setpriority() take a pid, and a cgroup v2
+ * placement is a write of the pid to the group's cgroup.procs. Processes
+ * the child starts after that inherit all three.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "jshell_sched.h"
+#include "utils/jbox_json.h"
+
+
+/**
+ * Parse a CPU list such as "0-3,6" into a set.
+ * @param text The list.
+ * @param set Set to the CPUs of the list.
+ * @return 0 on success, -1 if the list is malformed or names a CPU
+ *         beyond CPU_SETSIZE.
+ */
+static int parse_cpu_list(const char* text, cpu_set_t* set) {
+  CPU_ZERO(set);
+  const char* p = text;
+  while (*p != '\0') {
+    char* end;
+    errno = 0;
+    long first = strtol(p, &end, 10);
+    if (end == p || errno != 0 || first < 0 || first >= CPU_SETSIZE) {
+      return -1;
+    }
+    long last = first;
+    p = end;
+    if (*p == '-') {
+      p++;
+      last = strtol(p, &end, 10);
+      if (end == p || errno != 0 || last < first || last >= CPU_SETSIZE) {
+        return -1;
+      }
+      p = end;
+    }
+    for (long cpu = first; cpu <= last; cpu++) {
+      CPU_SET((int)cpu, set);
+    }
+    if (*p == ',') {
+      p++;
+      if (*p == '\0') {
+        return -1;
+      }
+    } else if (*p != '\0') {
+      return -1;
+    }
+  }
+  return p == text ? -1 : 0;
+}
+
+
+/**
+ * Parse a --nice value.
+ * @param text The value.
+ * @param nice Set to the value.
+ * @return 0 on success, -1 unless it is an integer in -20..19.
+ */
+static int parse_nice(const char* text, int* nice) {
+  char* end;
+  errno = 0;
+  long value = strtol(text, &end, 10);
+  if (end == text || *end != '\0' || errno != 0 || value < -20
+      || value > 19) {
+    return -1;
+  }
+  *nice = (int)value;
+  return 0;
+}
+
+
+/**
+ * Make the absolute directory of a --cgroup path.
+ * @param text The path, absolute or relative to JSHELL_CGROUP_ROOT.
+ * @return Allocated path, or NULL if memory ran out.
+ */
+static char* cgroup_dir(const char* text) {
+  if (text[0] == '/') {
+    return strdup(text);
+  }
+  char* dir = NULL;
+  if (asprintf(&dir, "%s/%s", JSHELL_CGROUP_ROOT, text) == -1) {
+    return NULL;
+  }
+  return dir;
+}
+
+
+/**
+ * Parse a run prefix; see jshell_sched.h.
+ * Options come before the command only, so the command's own --nice and
+ * the like are left alone.
+ */
+int jshell_sched_parse_prefix(JShellSched* sched, int argc, char** argv,
+                              const char** error) {
+  if (argc < 2 || strcmp(argv[0], "run") != 0) {
+    return 0;
+  }
+
+  int i = 1;
+  while (i < argc && argv[i][0] == '-') {
+    const char* opt = argv[i];
+    if (strcmp(opt, "--") == 0) {
+      i++;
+      break;
+    }
+    bool known = strcmp(opt, "--cpus") == 0 || strcmp(opt, "--nice") == 0
+                 || strcmp(opt, "--cgroup") == 0;
+    if (!known) {
+      /* --help and unknown options go to the run builtin */
+      jshell_sched_free(sched);
+      return 0;
+    }
+    if (i + 1 >= argc) {
+      *error = "option needs a value";
+      jshell_sched_free(sched);
+      return -1;
+    }
+
+    const char* value = argv[i + 1];
+    if (strcmp(opt, "--cpus") == 0) {
+      cpu_set_t set;
+      if (parse_cpu_list(value, &set) != 0) {
+        *error = "--cpus takes a list such as 0-3,6";
+        jshell_sched_free(sched);
+        return -1;
+      }
+      free(sched->cpus);
+      sched->cpus = strdup(value);
+    } else if (strcmp(opt, "--nice") == 0) {
+      if (parse_nice(value, &sched->nice) != 0) {
+        *error = "--nice takes a value from -20 to 19";
+        jshell_sched_free(sched);
+        return -1;
+      }
+      sched->has_nice = true;
+    } else {
+      free(sched->cgroup);
+      sched->cgroup = cgroup_dir(value);
+    }
+    if ((strcmp(opt, "--cpus") == 0 && sched->cpus == NULL)
+        || (strcmp(opt, "--cgroup") == 0 && sched->cgroup == NULL)) {
+      *error = strerror(ENOMEM);
+      jshell_sched_free(sched);
+      return -1;
+    }
+    i += 2;
+  }
+
+  if (i >= argc) {
+    /* No command: the run builtin reports it */
+    jshell_sched_free(sched);
+    return 0;
+  }
+  return i;
+}
+
+
+/**
+ * Check whether any placement is set.
+ * @param sched Placement, or NULL.
+ * @return true if run set CPUs, a nice value or a cgroup.
+ */
+bool jshell_sched_is_set(const JShellSched* sched) {
+  return sched != NULL
+         && (sched->cpus != NULL || sched->has_nice || sched->cgroup != NULL);
+}
+
+
+/**
+ * Move a process into a cgroup v2 group.
+ * @param dir Group directory.
+ * @param pid Process.
+ * @return 0 on success, -1 with errno set.
+ */
+static int join_cgroup(const char* dir, pid_t pid) {
+  char path[PATH_MAX];
+  if (snprintf(path, sizeof(path), "%s/cgroup.procs", dir)
+      >= (int)sizeof(path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  int fd = open(path, O_WRONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return -1;
+  }
+  char text[24];
+  int len = snprintf(text, sizeof(text), "%d\n", (int)pid);
+  ssize_t n = write(fd, text, (size_t)len);
+  int err = errno;
+  close(fd);
+  if (n != len) {
+    errno = n == -1 ? err : EIO;
+    return -1;
+  }
+  return 0;
+}
+
+
+/**
+ * Apply a placement to a started process; see jshell_sched.h.
+ * The cgroup comes first, so a cpuset of the group does not undo the
+ * affinity set after it.
+ */
+int jshell_sched_apply(const JShellSched* sched, pid_t pid) {
+  if (!jshell_sched_is_set(sched) || pid <= 0) {
+    return 0;
+  }
+
+  int result = 0;
+  if (sched->cgroup != NULL && join_cgroup(sched->cgroup, pid) != 0) {
+    fprintf(stderr, "jshell: run: cgroup %s: %s\n", sched->cgroup,
+            strerror(errno));
+    result = -1;
+  }
+  if (sched->cpus != NULL) {
+    cpu_set_t set;
+    if (parse_cpu_list(sched->cpus, &set) != 0
+        || sched_setaffinity(pid, sizeof(set), &set) != 0) {
+      fprintf(stderr, "jshell: run: cpus %s: %s\n", sched->cpus,
+              strerror(errno != 0 ? errno : EINVAL));
+      result = -1;
+    }
+  }
+  if (sched->has_nice && setpriority(PRIO_PROCESS, (id_t)pid,
+                                     sched->nice) != 0) {
+    fprintf(stderr, "jshell: run: nice %d: %s\n", sched->nice,
+            strerror(errno));
+    result = -1;
+  }
+  return result;
+}
+
+
+/**
+ * Deep-copy a placement.
+ * @param dst Destination (overwritten).
+ * @param src Source, or NULL for none.
+ * @return 0 on success, -1 if memory ran out (dst is then empty).
+ */
+int jshell_sched_copy(JShellSched* dst, const JShellSched* src) {
+  *dst = (JShellSched){0};
+  if (src == NULL) {
+    return 0;
+  }
+  dst->has_nice = src->has_nice;
+  dst->nice = src->nice;
+  dst->cpus = src->cpus != NULL ? strdup(src->cpus) : NULL;
+  dst->cgroup = src->cgroup != NULL ? strdup(src->cgroup) : NULL;
+  if ((src->cpus != NULL && dst->cpus == NULL)
+      || (src->cgroup != NULL && dst->cgroup == NULL)) {
+    jshell_sched_free(dst);
+    return -1;
+  }
+  return 0;
+}
+
+
+/**
+ * Release the strings of a placement and zero it.
+ * @param sched Placement.
+ */
+void jshell_sched_free(JShellSched* sched) {
+  free(sched->cpus);
+  free(sched->cgroup);
+  *sched = (JShellSched){0};
+}
+
+
+/**
+ * Write a placement as a JSON object.
+ * @param out Output stream.
+ * @param sched Placement.
+ */
+void jshell_sched_write_json(FILE* out, const JShellSched* sched) {
+  const char* sep = "";
+  fputc('{', out);
+  if (sched->cpus != NULL) {
+    fputs("\"cpus\": ", out);
+    jbox_json_write_string(out, sched->cpus);
+    sep = ", ";
+  }
+  if (sched->has_nice) {
+    fprintf(out, "%s\"nice\": %d", sep, sched->nice);
+    sep = ", ";
+  }
+  if (sched->cgroup != NULL) {
+    fprintf(out, "%s\"cgroup\": ", sep);
+    jbox_json_write_string(out, sched->cgroup);
+  }
+  fputc('}', out);
+}
@@ -0,0 +1,49 @@
+#ifndef JSHELL_SCHED_H
+#define JSHELL_SCHED_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+
+// Cgroup v2 hierarchy that relative --cgroup paths are under
+#define JSHELL_CGROUP_ROOT "/sys/fs/cgroup"
+
+
+// Where a job's processes run, from `run --cpus/--nice/--cgroup command`
+typedef struct {
+  char* cpus;         // --cpus list as given ("0-3,6"), or NULL
+  bool has_nice;
+  int nice;
+  char* cgroup;       // Absolute cgroup directory, or NULL
+} JShellSched;
+
+
+// Parse a `run [--cpus LIST] [--nice N] [--cgroup PATH] command ...`
+// prefix into sched (zeroed by the caller; free with jshell_sched_free())
+// Returns the number of words before the command, 0 if argv does not
+// start with a run prefix followed by a command, or -1 with *error set
+// to a message if an option is malformed
+int jshell_sched_parse_prefix(JShellSched* sched, int argc, char** argv,
+                              const char** error);
+
+// Whether any placement is set
+bool jshell_sched_is_set(const JShellSched* sched);
+
+// Apply the placement to a started process; problems are reported on
+// stderr and leave the process running where it is
+// Returns 0 if everything was applied, -1 otherwise
+int jshell_sched_apply(const JShellSched* sched, pid_t pid);
+
+// Deep-copy a placement; returns 0, or -1 if memory ran out
+int jshell_sched_copy(JShellSched* dst, const JShellSched* src);
+
+// Release the strings of a placement and zero it
+void jshell_sched_free(JShellSched* sched);
+
+// Write the placement as a JSON object ({"cpus": ..., "nice": ...,
+// "cgroup": ...}, with only the fields that are set)
+void jshell_sched_write_json(FILE* out, const JShellSched* sched);
+
+
+#endif
@@ -0,0 +1,444 @@
+/**
+ * @file jshell_script_cache.c
+ * @brief Compiled scripts (.jshc) kept in ~/.jshell/cache.
+ *
+ * A script runs top to bottom and stops only at `exit`, a parse error or
+ * a signal, so the plans of its commands in order are all a later run
+ * needs. A .jshc file holds them after a small header:
+ *
+ *   header   magic, format, hash and length of the script text, size and
+ *            mtime of the jshell binary, number of steps
+ *   steps    per step a record (kind, exit status, plan size) followed by
+ *            the plan block from jshell_plan_serialize(), padded to 16
+ *
+ * Files are named after the script hash, so identical scripts share one
+ * and an edited script simply misses. The binary's size and mtime stand
+ * in for its version: a rebuilt jshell recompiles rather than trust plans
+ * laid out by another build. Files are written to a temporary name and
+ * renamed into place; a reader maps one privately and relocates its plans
+ * in place, so loading costs a hash of the text and one pass over the
+ * plans.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "jshell_script_cache.h"
+#include "jshell_vars.h"
+#include "utils/jbox_utils.h"
+
+
+#define SCRIPT_CACHE_MAGIC "JSHC"
+
+/** Bump whenever the file or plan layout changes */
+#define SCRIPT_CACHE_FORMAT 1
+
+/** Alignment of every record and plan block in the file */
+#define SCRIPT_CACHE_ALIGN 16
+
+
+typedef struct {
+  char magic[4];
+  uint32_t format;
+  uint64_t source_hash;
+  uint64_t source_len;
+  uint64_t exe_size;
+  int64_t exe_mtime_sec;
+  int64_t exe_mtime_nsec;
+  uint64_t step_count;
+} ScriptCacheHeader;
+
+
+typedef struct {
+  uint32_t kind;
+  int32_t exit_status;
+  uint64_t plan_size;
+} ScriptStepRecord;
+
+
+/**
+ * Round a file offset up to the record alignment.
+ * @param n Offset.
+ * @return Aligned offset.
+ */
+static size_t align_up(size_t n) {
+  return (n + SCRIPT_CACHE_ALIGN - 1) & ~(size_t)(SCRIPT_CACHE_ALIGN - 1);
+}
+
+
+/**
+ * Check whether compiled scripts are turned off with
+ * JSHELL_NO_SCRIPT_CACHE.
+ * @return true if the cache must not be used.
+ */
+static bool script_cache_disabled(void) {
+  const char* off = jshell_var_get("JSHELL_NO_SCRIPT_CACHE");
+  return off != NULL && off[0] != '\0' && strcmp(off, "0") != 0;
+}
+
+
+/**
+ * Hash the script text (FNV-1a).
+ * @param source Script text.
+ * @param len Length of the text.
+ * @return 64-bit hash.
+ */
+static uint64_t source_hash(const char* source, size_t len) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (unsigned char)source[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+
+/**
+ * Fill in the header fields that identify a script and the binary.
+ * @param header Header to fill (magic, format and steps are left alone).
+ * @param source Script text.
+ * @param source_len Length of the text.
+ * @return false if the running binary cannot be identified.
+ */
+static bool header_identify(ScriptCacheHeader* header, const char* source,
+                            size_t source_len) {
+  struct stat st;
+  if (stat("/proc/self/exe", &st) != 0) {
+    return false;
+  }
+  header->source_hash = source_hash(source, source_len);
+  header->source_len = source_len;
+  header->exe_size = (uint64_t)st.st_size;
+  header->exe_mtime_sec = (int64_t)st.st_mtim.tv_sec;
+  header->exe_mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+  return true;
+}
+
+
+/**
+ * Build the path of the compiled form of a script.
+ * @param hash Hash of the script text.
+ * @param make_dirs Create ~/.jshell/cache if it is missing.
+ * @return Allocated path, or NULL without a home directory or on error.
+ */
+static char* compiled_path(uint64_t hash, bool make_dirs) {
+  const char* home = getenv("HOME");
+  if (home == NULL || home[0] == '\0') {
+    struct passwd* pw = getpwuid(getuid());
+    home = pw != NULL ? pw->pw_dir : NULL;
+  }
+  if (home == NULL) {
+    return NULL;
+  }
+
+  char* path = NULL;
+  if (make_dirs) {
+    if (asprintf(&path, "%s/.jshell", home) == -1) {
+      return NULL;
+    }
+    mkdir(path, 0700);
+    free(path);
+    if (asprintf(&path, "%s%s", home, JSHELL_SCRIPT_CACHE_SUBPATH) == -1) {
+      return NULL;
+    }
+    if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+      free(path);
+      return NULL;
+    }
+    free(path);
+  }
+
+  if (asprintf(&path, "%s%s/%016llx.jshc", home, JSHELL_SCRIPT_CACHE_SUBPATH,
+               (unsigned long long)hash) == -1) {
+    return NULL;
+  }
+  return path;
+}
+
+
+/**
+ * Walk the step records of a mapped file and relocate their plans.
+ * @param script Script whose map is set; its steps are filled in.
+ * @param step_count Steps the header announces.
+ * @return true if every record and plan is well formed.
+ */
+static bool load_steps(JShellCompiledScript* script, uint64_t step_count) {
+  char* data = script->map;
+  size_t size = script->map_size;
+  size_t pos = align_up(sizeof(ScriptCacheHeader));
+
+  if (step_count > size / sizeof(ScriptStepRecord)) {
+    return false;
+  }
+  script->steps = calloc(step_count > 0 ? step_count : 1,
+                         sizeof(JShellScriptStep));
+  if (script->steps == NULL) {
+    return false;
+  }
+
+  for (size_t i = 0; i < step_count; i++) {
+    if (pos > size || size - pos < sizeof(ScriptStepRecord)) {
+      return false;
+    }
+    ScriptStepRecord record;
+    memcpy(&record, data + pos, sizeof(record));
+    pos += sizeof(record);
+
+    JShellScriptStep* step = &script->steps[i];
+    if (record.kind == SCRIPT_STEP_EXIT) {
+      step->kind = SCRIPT_STEP_EXIT;
+      step->exit_status = record.exit_status;
+    } else if (record.kind == SCRIPT_STEP_PLAN) {
+      if (record.plan_size > size - pos) {
+        return false;
+      }
+      step->kind = SCRIPT_STEP_PLAN;
+      step->plan = jshell_plan_relocate(data + pos, record.plan_size);
+      if (step->plan == NULL) {
+        return false;
+      }
+      pos = align_up(pos + record.plan_size);
+    } else {
+      return false;
+    }
+    script->step_count++;
+  }
+  return true;
+}
+
+
+/**
+ * Map the compiled form of a script.
+ * @param source Script text.
+ * @param source_len Length of the text.
+ * @param script Filled in on success.
+ * @return true on a hit; false on a miss, a stale or damaged file, or
+ *         when the cache is turned off.
+ */
+bool jshell_script_cache_load(const char* source, size_t source_len,
+                              JShellCompiledScript* script) {
+  *script = (JShellCompiledScript){0};
+  ScriptCacheHeader want = {0};
+  if (script_cache_disabled()
+      || !header_identify(&want, source, source_len)) {
+    return false;
+  }
+
+  char* path = compiled_path(want.source_hash, false);
+  if (path == NULL) {
+    return false;
+  }
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  free(path);
+  if (fd == -1) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0
+      || (size_t)st.st_size < align_up(sizeof(ScriptCacheHeader))) {
+    close(fd);
+    return false;
+  }
+  /* Private and writable: plans are relocated in the mapping itself */
+  void* map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+  script->map = map;
+  script->map_size = (size_t)st.st_size;
+
+  ScriptCacheHeader header;
+  memcpy(&header, map, sizeof(header));
+  bool valid = memcmp(header.magic, SCRIPT_CACHE_MAGIC, 4) == 0
+               && header.format == SCRIPT_CACHE_FORMAT
+               && header.source_hash == want.source_hash
+               && header.source_len == want.source_len
+               && header.exe_size == want.exe_size
+               && header.exe_mtime_sec == want.exe_mtime_sec
+               && header.exe_mtime_nsec == want.exe_mtime_nsec
+               && load_steps(script, header.step_count);
+  if (!valid) {
+    DPRINT("Compiled script for %016llx is stale or damaged",
+           (unsigned long long)want.source_hash);
+    jshell_script_cache_unload(script);
+    return false;
+  }
+
+  DPRINT("Loaded compiled script %016llx: %zu steps",
+         (unsigned long long)want.source_hash, script->step_count);
+  return true;
+}
+
+
+/**
+ * Unmap a compiled script.
+ * @param script Script from jshell_script_cache_load(); left empty.
+ */
+void jshell_script_cache_unload(JShellCompiledScript* script) {
+  free(script->steps);
+  if (script->map != NULL) {
+    munmap(script->map, script->map_size);
+  }
+  *script = (JShellCompiledScript){0};
+}
+
+
+/**
+ * Start compiling a script as it runs.
+ * @param compiler Compiler to set up.
+ * @return false if the cache is turned off or memory ran out.
+ */
+bool jshell_script_compiler_init(JShellScriptCompiler* compiler) {
+  *compiler = (JShellScriptCompiler){0};
+  if (script_cache_disabled()) {
+    return false;
+  }
+  compiler->out = open_memstream(&compiler->data, &compiler->size);
+  return compiler->out != NULL;
+}
+
+
+/**
+ * Append a step record, and the plan block for a plan step.
+ * @param compiler Compiler, or NULL.
+ * @param record Step record.
+ * @param plan Plan of a plan step, or NULL.
+ */
+static void compiler_add(JShellScriptCompiler* compiler,
+                         const ScriptStepRecord* record,
+                         const JShellPlan* plan) {
+  if (compiler == NULL || compiler->failed) {
+    return;
+  }
+
+  static const char padding[SCRIPT_CACHE_ALIGN];
+  bool ok = fwrite(record, sizeof(*record), 1, compiler->out) == 1;
+  if (ok && plan != NULL) {
+    void* block = malloc(plan->size);
+    if (block != NULL) {
+      jshell_plan_serialize(plan, block);
+      ok = fwrite(block, plan->size, 1, compiler->out) == 1;
+      free(block);
+    } else {
+      ok = false;
+    }
+    size_t pad = align_up(plan->size) - plan->size;
+    ok = ok && (pad == 0 || fwrite(padding, pad, 1, compiler->out) == 1);
+  }
+  if (!ok) {
+    compiler->failed = true;
+    return;
+  }
+  compiler->step_count++;
+}
+
+
+/**
+ * Append a step that runs a plan.
+ * @param compiler Compiler, or NULL.
+ * @param plan Plan the command line lowered to.
+ */
+void jshell_script_compiler_add_plan(JShellScriptCompiler* compiler,
+                                     const JShellPlan* plan) {
+  ScriptStepRecord record = {
+    .kind = SCRIPT_STEP_PLAN,
+    .plan_size = plan->size
+  };
+  compiler_add(compiler, &record, plan);
+}
+
+
+/**
+ * Append an exit step.
+ * @param compiler Compiler, or NULL.
+ * @param exit_status Status of `exit N`, or -1 for a bare `exit`.
+ */
+void jshell_script_compiler_add_exit(JShellScriptCompiler* compiler,
+                                     int exit_status) {
+  ScriptStepRecord record = {
+    .kind = SCRIPT_STEP_EXIT,
+    .exit_status = exit_status
+  };
+  compiler_add(compiler, &record, NULL);
+}
+
+
+/**
+ * Mark a compilation incomplete.
+ * @param compiler Compiler, or NULL.
+ */
+void jshell_script_compiler_fail(JShellScriptCompiler* compiler) {
+  if (compiler != NULL) {
+    compiler->failed = true;
+  }
+}
+
+
+/**
+ * Write the compiled script, unless the compilation failed, and release
+ * the compiler. Errors only cost the next run a parse, so they are
+ * ignored.
+ * @param compiler Compiler from jshell_script_compiler_init().
+ * @param source Script text that was run.
+ * @param source_len Length of the text.
+ */
+void jshell_script_compiler_finish(JShellScriptCompiler* compiler,
+                                   const char* source, size_t source_len) {
+  if (compiler->out == NULL) {
+    return;
+  }
+  fclose(compiler->out);
+  compiler->out = NULL;
+
+  ScriptCacheHeader header = {
+    .magic = { 'J', 'S', 'H', 'C' },
+    .format = SCRIPT_CACHE_FORMAT,
+    .step_count = compiler->step_count
+  };
+  char* path = NULL;
+  char* tmp = NULL;
+  if (compiler->failed || !header_identify(&header, source, source_len)
+      || (path = compiled_path(header.source_hash, true)) == NULL
+      || asprintf(&tmp, "%s.%ld.tmp", path, (long)getpid()) == -1) {
+    free(path);
+    free(compiler->data);
+    *compiler = (JShellScriptCompiler){0};
+    return;
+  }
+
+  static const char padding[SCRIPT_CACHE_ALIGN];
+  size_t header_pad = align_up(sizeof(header)) - sizeof(header);
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  bool ok = fd != -1
+            && write(fd, &header, sizeof(header)) == (ssize_t)sizeof(header)
+            && (header_pad == 0
+                || write(fd, padding, header_pad) == (ssize_t)header_pad)
+            && (compiler->size == 0
+                || write(fd, compiler->data, compiler->size)
+                   == (ssize_t)compiler->size);
+  if (fd != -1) {
+    ok = close(fd) == 0 && ok;
+  }
+  if (ok && rename(tmp, path) == 0) {
+    DPRINT("Saved compiled script %s: %zu steps", path,
+           compiler->step_count);
+  } else {
+    unlink(tmp);
+  }
+
+  free(tmp);
+  free(path);
+  free(compiler->data);
+  *compiler = (JShellScriptCompiler){0};
+}
@@ -0,0 +1,85 @@
+#ifndef JSHELL_SCRIPT_CACHE_H
+#define JSHELL_SCRIPT_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "ast/jshell_ast_plan.h"
+
+
+// Directory of compiled scripts, under the home directory
+#define JSHELL_SCRIPT_CACHE_SUBPATH "/.jshell/cache"
+
+
+// Compiled scripts (.jshc): the lowered plans of a script's commands,
+// keyed by a hash of the script text and the identity of the jshell
+// binary, kept in ~/.jshell/cache. A script run for the first time is
+// compiled as it runs and saved once it has run to its end; later runs
+// map the file and execute the plans without parsing a line. Set
+// JSHELL_NO_SCRIPT_CACHE=1 to neither read nor write compiled scripts
+
+
+// What a step of a compiled script does
+typedef enum {
+  SCRIPT_STEP_PLAN,      // Run plan
+  SCRIPT_STEP_EXIT       // Stop with exit_status (-1: last exit status)
+} JShellScriptStepKind;
+
+
+typedef struct {
+  JShellScriptStepKind kind;
+  int exit_status;
+  const JShellPlan* plan;
+} JShellScriptStep;
+
+
+// A compiled script mapped from the cache
+typedef struct {
+  JShellScriptStep* steps;
+  size_t step_count;
+  void* map;
+  size_t map_size;
+} JShellCompiledScript;
+
+
+// A script being compiled while it runs
+typedef struct {
+  FILE* out;             // Memory stream of the step records
+  char* data;
+  size_t size;
+  size_t step_count;
+  bool failed;           // Incomplete run or error: nothing is saved
+} JShellScriptCompiler;
+
+
+// Map the compiled form of the script whose text is source
+// Returns false if there is none, it is stale or damaged, or the cache is
+// turned off
+bool jshell_script_cache_load(const char* source, size_t source_len,
+                              JShellCompiledScript* script);
+
+// Unmap a compiled script from jshell_script_cache_load()
+void jshell_script_cache_unload(JShellCompiledScript* script);
+
+// Start compiling a script; returns false if the cache is turned off
+bool jshell_script_compiler_init(JShellScriptCompiler* compiler);
+
+// Append a step running plan, or an exit step (exit_status -1: the last
+// exit status); compiler may be NULL
+void jshell_script_compiler_add_plan(JShellScriptCompiler* compiler,
+                                     const JShellPlan* plan);
+void jshell_script_compiler_add_exit(JShellScriptCompiler* compiler,
+                                     int exit_status);
+
+// Mark the compilation incomplete, so it is not saved; compiler may be
+// NULL
+void jshell_script_compiler_fail(JShellScriptCompiler* compiler);
+
+// Save the compiled script for source unless it failed, and release the
+// compiler
+void jshell_script_compiler_finish(JShellScriptCompiler* compiler,
+                                   const char* source, size_t source_len);
+
+
+#endif
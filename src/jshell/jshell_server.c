@@ -0,0 +1,488 @@
+/**
+ * @file jshell_server.c
+ * @brief Persistent shell server answering command requests on a socket.
+ *
+ * `jshell --serve PATH` initializes the shell once and listens on a Unix
+ * socket. Each client connection is served by a fork of the initialized
+ * shell, so registries, the package table and the PATH setup are ready
+ * without paying startup per command, and a client's cd/export affect
+ * only its own connection.
+ *
+ * Requests and responses are single-line JSON objects:
+ *
+ *   {"id": 1, "command": "ls | head", "cwd": "/tmp", "env": {"K": "V"}}
+ *   {"id": 1, "status": "ok", "exit_status": 0, "stdout": "...",
+ *    "stderr": "..."}
+ *
+ * Only "command" is required. "cwd" and "env" are applied before the
+ * command runs and persist for the rest of the connection. "id" (string
+ * or number) is echoed back. Malformed requests get
+ * {"status": "error", "message": "..."} and the connection stays open.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "jshell_server.h"
+#include "jshell_cwd.h"
+#include "jshell_event_loop.h"
+#include "jshell_signals.h"
+#include "jshell_stats.h"
+#include "jshell_vars.h"
+#include "jshell.h"
+#include "utils/jbox_json.h"
+#include "utils/jbox_utils.h"
+
+
+/** Pending connections the listening socket queues */
+#define SERVER_BACKLOG 64
+
+
+/** One parsed request line */
+typedef struct {
+  char *id;            // Raw id token or decoded id string, or NULL
+  bool id_is_string;
+  char *command;
+  char *cwd;
+  char **env_names;
+  char **env_values;
+  size_t env_count;
+} ServerRequest;
+
+
+/**
+ * Release everything a request owns.
+ * @param req Request to clear.
+ */
+static void free_request(ServerRequest *req) {
+  free(req->id);
+  free(req->command);
+  free(req->cwd);
+  for (size_t i = 0; i < req->env_count; i++) {
+    free(req->env_names[i]);
+    free(req->env_values[i]);
+  }
+  free(req->env_names);
+  free(req->env_values);
+  memset(req, 0, sizeof(*req));
+}
+
+
+/**
+ * Parse the "env" object of a request.
+ * @param r Reader positioned before the object.
+ * @param req Request receiving the variables.
+ * @return 0 on success, -1 if malformed.
+ */
+static int parse_env(jbox_json_reader_t *r, ServerRequest *req) {
+  if (jbox_json_next(r) != JBOX_JSON_OBJECT_BEGIN) {
+    return -1;
+  }
+
+  jbox_json_event_t ev;
+  while ((ev = jbox_json_next(r)) == JBOX_JSON_KEY) {
+    char *name = strdup(r->text);
+    char *value = name != NULL ? jbox_json_read_string(r) : NULL;
+    if (value == NULL) {
+      free(name);
+      return -1;
+    }
+
+    char **names = realloc(req->env_names,
+                           (req->env_count + 1) * sizeof(char *));
+    if (names != NULL) {
+      req->env_names = names;
+    }
+    char **values = realloc(req->env_values,
+                            (req->env_count + 1) * sizeof(char *));
+    if (values != NULL) {
+      req->env_values = values;
+    }
+    if (names == NULL || values == NULL) {
+      free(name);
+      free(value);
+      return -1;
+    }
+    req->env_names[req->env_count] = name;
+    req->env_values[req->env_count] = value;
+    req->env_count++;
+  }
+
+  return ev == JBOX_JSON_OBJECT_END ? 0 : -1;
+}
+
+
+/**
+ * Parse the "id" of a request. Strings and numbers are kept for echoing;
+ * any other value is ignored.
+ * @param r Reader positioned before the value.
+ * @param req Request receiving the id.
+ * @return 0 on success, -1 if malformed.
+ */
+static int parse_id(jbox_json_reader_t *r, ServerRequest *req) {
+  jbox_json_event_t ev = jbox_json_next(r);
+  if (ev != JBOX_JSON_STRING && ev != JBOX_JSON_NUMBER) {
+    return jbox_json_skip(r, ev);
+  }
+
+  free(req->id);
+  req->id = strdup(r->text);
+  req->id_is_string = ev == JBOX_JSON_STRING;
+  return req->id != NULL ? 0 : -1;
+}
+
+
+/**
+ * Parse one request line.
+ * @param line Request text.
+ * @param len Length of line in bytes.
+ * @param req Zeroed request to fill in.
+ * @return NULL on success, or a message describing the problem.
+ */
+static const char *parse_request(const char *line, size_t len,
+                                 ServerRequest *req) {
+  jbox_json_reader_t r;
+  jbox_json_reader_init(&r, line, len);
+
+  const char *error = NULL;
+  jbox_json_event_t ev = jbox_json_next(&r);
+  if (ev != JBOX_JSON_OBJECT_BEGIN) {
+    error = "request must be a JSON object";
+  }
+
+  while (error == NULL && (ev = jbox_json_next(&r)) == JBOX_JSON_KEY) {
+    bool ok;
+    if (strcmp(r.text, "env") == 0) {
+      ok = parse_env(&r, req) == 0;
+    } else if (strcmp(r.text, "command") == 0) {
+      free(req->command);
+      req->command = jbox_json_read_string(&r);
+      ok = req->command != NULL;
+    } else if (strcmp(r.text, "cwd") == 0) {
+      free(req->cwd);
+      req->cwd = jbox_json_read_string(&r);
+      ok = req->cwd != NULL;
+    } else if (strcmp(r.text, "id") == 0) {
+      ok = parse_id(&r, req) == 0;
+    } else {
+      ok = jbox_json_skip(&r, jbox_json_next(&r)) == 0;
+    }
+    if (!ok) {
+      error = "malformed request";
+    }
+  }
+
+  if (error == NULL && (ev != JBOX_JSON_OBJECT_END
+                        || jbox_json_next(&r) != JBOX_JSON_DONE)) {
+    error = "malformed request";
+  }
+  jbox_json_reader_free(&r);
+
+  if (error == NULL && req->command == NULL) {
+    error = "missing \"command\"";
+  }
+  return error;
+}
+
+
+/**
+ * Start a response object, echoing the request id if there was one.
+ * @param out Client stream.
+ * @param req Request being answered.
+ */
+static void begin_response(FILE *out, const ServerRequest *req) {
+  fputc('{', out);
+  if (req->id != NULL) {
+    fputs("\"id\": ", out);
+    if (req->id_is_string) {
+      jbox_json_write_string(out, req->id);
+    } else {
+      fputs(req->id, out);
+    }
+    fputs(", ", out);
+  }
+}
+
+
+/**
+ * Send an error response.
+ * @param out Client stream.
+ * @param req Request being answered.
+ * @param message What went wrong.
+ */
+static void send_error(FILE *out, const ServerRequest *req,
+                       const char *message) {
+  begin_response(out, req);
+  fputs("\"status\": \"error\", \"message\": ", out);
+  jbox_json_write_string(out, message);
+  fputs("}\n", out);
+  fflush(out);
+}
+
+
+/**
+ * Read back everything written to a capture file.
+ * @param fd Capture descriptor.
+ * @param len Set to the number of bytes read.
+ * @return Allocated contents (possibly empty), or NULL on error.
+ */
+static char *read_capture(int fd, size_t *len) {
+  off_t size = lseek(fd, 0, SEEK_END);
+  if (size < 0) {
+    return NULL;
+  }
+
+  char *data = malloc((size_t)size + 1);
+  if (data == NULL) {
+    return NULL;
+  }
+
+  size_t done = 0;
+  while (done < (size_t)size) {
+    ssize_t n = pread(fd, data + done, (size_t)size - done, (off_t)done);
+    if (n <= 0) {
+      if (n == -1 && errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    done += (size_t)n;
+  }
+
+  *len = done;
+  return data;
+}
+
+
+/**
+ * Run a request's command with stdout and stderr captured.
+ *
+ * The command runs with fds 1 and 2 pointing at memory files, so builtins,
+ * spawned children and error messages are all captured without a reader
+ * having to keep up with a pipe.
+ *
+ * @param out Client stream.
+ * @param req Parsed request.
+ */
+static void run_request(FILE *out, const ServerRequest *req) {
+  for (size_t i = 0; i < req->env_count; i++) {
+    jshell_var_set(req->env_names[i], req->env_values[i], JSHELL_VAR_EXPORT);
+  }
+
+  if (req->cwd != NULL && jshell_cwd_change(req->cwd) != 0) {
+    char message[512];
+    snprintf(message, sizeof(message), "cd: %s: %s", req->cwd,
+             strerror(errno));
+    send_error(out, req, message);
+    return;
+  }
+
+  int out_fd = memfd_create("jshell-stdout", MFD_CLOEXEC);
+  int err_fd = memfd_create("jshell-stderr", MFD_CLOEXEC);
+  int saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+  int saved_err = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 3);
+  if (out_fd < 0 || err_fd < 0 || saved_out < 0 || saved_err < 0) {
+    send_error(out, req, strerror(errno));
+    if (out_fd >= 0) close(out_fd);
+    if (err_fd >= 0) close(err_fd);
+    if (saved_out >= 0) close(saved_out);
+    if (saved_err >= 0) close(saved_err);
+    return;
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+  dup2(out_fd, STDOUT_FILENO);
+  dup2(err_fd, STDERR_FILENO);
+
+  int exit_status = jshell_exec_string(req->command);
+
+  fflush(stdout);
+  fflush(stderr);
+  dup2(saved_out, STDOUT_FILENO);
+  dup2(saved_err, STDERR_FILENO);
+  close(saved_out);
+  close(saved_err);
+
+  size_t out_len = 0;
+  size_t err_len = 0;
+  char *out_data = read_capture(out_fd, &out_len);
+  char *err_data = read_capture(err_fd, &err_len);
+  close(out_fd);
+  close(err_fd);
+
+  begin_response(out, req);
+  fprintf(out, "\"status\": \"ok\", \"exit_status\": %d, \"stdout\": ",
+          exit_status);
+  jbox_json_write_string_n(out, out_data, out_data ? out_len : 0);
+  fputs(", \"stderr\": ", out);
+  jbox_json_write_string_n(out, err_data, err_data ? err_len : 0);
+  fputs("}\n", out);
+  fflush(out);
+
+  free(out_data);
+  free(err_data);
+}
+
+
+/**
+ * Answer requests from one client until it disconnects.
+ * Runs in the forked child that owns the connection.
+ * @param client_fd Connected socket.
+ */
+static void serve_client(int client_fd) {
+  // Commands must not read the server's own stdin
+  int null_fd = open("/dev/null", O_RDONLY);
+  if (null_fd >= 0) {
+    dup2(null_fd, STDIN_FILENO);
+    close(null_fd);
+  }
+
+  int out_fd = fcntl(client_fd, F_DUPFD_CLOEXEC, 3);
+  FILE *in = fdopen(client_fd, "r");
+  FILE *out = out_fd >= 0 ? fdopen(out_fd, "w") : NULL;
+  if (in == NULL || out == NULL) {
+    perror("jshell: fdopen");
+    return;
+  }
+
+  char *line = NULL;
+  size_t line_cap = 0;
+  ssize_t len;
+
+  while ((len = getline(&line, &line_cap, in)) != -1) {
+    if (line[strspn(line, " \t\r\n")] == '\0') {
+      continue;
+    }
+
+    ServerRequest req = {0};
+    const char *error = parse_request(line, (size_t)len, &req);
+    if (error != NULL) {
+      send_error(out, &req, error);
+    } else {
+      run_request(out, &req);
+    }
+    free_request(&req);
+
+    if (ferror(out)) {
+      break;
+    }
+  }
+
+  free(line);
+  fclose(in);
+  fclose(out);
+}
+
+
+/**
+ * Create the listening socket, replacing a stale socket file.
+ * A path that still accepts connections belongs to a live server and is
+ * left alone.
+ * @param socket_path Filesystem path of the socket.
+ * @return Listening descriptor, or -1 with an error printed.
+ */
+static int open_listener(const char *socket_path) {
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "jshell: socket path too long: %s\n", socket_path);
+    return -1;
+  }
+  strcpy(addr.sun_path, socket_path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    perror("jshell: socket");
+    return -1;
+  }
+
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+    fprintf(stderr, "jshell: %s: a server is already listening\n",
+            socket_path);
+    close(fd);
+    return -1;
+  }
+  unlink(socket_path);
+
+  // Only the owner may submit commands
+  mode_t old_umask = umask(077);
+  int rc = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+  umask(old_umask);
+
+  if (rc != 0 || listen(fd, SERVER_BACKLOG) != 0) {
+    fprintf(stderr, "jshell: %s: %s\n", socket_path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+
+/**
+ * Serve clients until the shell is told to stop.
+ *
+ * Each accepted connection is handed to a forked child; finished children
+ * are reaped through the job control descriptor while waiting for the
+ * next client.
+ *
+ * @param socket_path Filesystem path of the socket.
+ * @return 0 after a signal-requested shutdown, 1 on setup failure.
+ */
+int jshell_serve(const char *socket_path) {
+  int listen_fd = open_listener(socket_path);
+  if (listen_fd < 0) {
+    return 1;
+  }
+
+  fprintf(stderr, "jshell: serving on %s\n", socket_path);
+
+  while (!jshell_should_terminate() && !jshell_should_hangup()
+         && !jshell_is_interrupted()) {
+    JShellEvent event = jshell_event_wait_input(listen_fd);
+    if (event == JSHELL_EVENT_ERROR) {
+      perror("jshell: poll");
+      break;
+    }
+    if (event != JSHELL_EVENT_INPUT) {
+      continue;
+    }
+
+    int client_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (client_fd < 0) {
+      if (errno != EINTR && errno != ECONNABORTED) {
+        perror("jshell: accept");
+      }
+      continue;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(listen_fd);
+      serve_client(client_fd);
+      fflush(NULL);
+      _exit(0);
+    }
+    if (pid < 0) {
+      perror("jshell: fork");
+    } else {
+      jshell_stats_add(JSHELL_STAT_FORKS, 1);
+    }
+    DPRINT("Client connection handled by pid %d", pid);
+    close(client_fd);
+  }
+
+  close(listen_fd);
+  unlink(socket_path);
+  return 0;
+}
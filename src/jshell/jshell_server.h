@@ -0,0 +1,13 @@
+#ifndef JSHELL_SERVER_H
+#define JSHELL_SERVER_H
+
+
+// Serve command requests on a Unix socket until SIGINT/SIGTERM/SIGHUP
+// The shell must be initialized; every client gets a fork of that state,
+// so its working directory and environment changes stay private to it
+// Protocol: one JSON object per line each way, see jshell_server.c
+// Returns the shell exit status (0 on a clean shutdown)
+int jshell_serve(const char *socket_path);
+
+
+#endif
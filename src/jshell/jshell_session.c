@@ -0,0 +1,302 @@
+/**
+ * @file jshell_session.c
+ * @brief In-process shell sessions for hosts linking libjshell.
+ *
+ * A session runs a command line the way `jshell -c` does, through
+ * jshell_exec_string(), so it shares the parse cache, builtins and linked
+ * apps of the shell and spawns nothing but the external programs the
+ * line itself runs. As in the socket server, fds 1 and 2 point somewhere
+ * else while the line runs, so builtins, apps, spawned children and the
+ * shell's own error messages are all captured. Here they are pipes,
+ * drained by a helper thread that hands each chunk to the host as it
+ * arrives instead of after the line has finished.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "jshell_session.h"
+#include "jshell.h"
+#include "jshell_cwd.h"
+
+
+/** Bytes read from a capture pipe at a time */
+#define SESSION_READ_CHUNK (64 * 1024)
+
+
+/** Output collected for a stream without a callback */
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+} SessionBuffer;
+
+
+struct JShellSession {
+  JShellCwd *cwd;      // Working directory, the shell's while a line runs
+  SessionBuffer out;
+  SessionBuffer err;
+};
+
+
+/** What the drain thread reads and where it delivers it */
+typedef struct {
+  int fds[2];                // Read ends of the stdout and stderr pipes
+  int stop_fd;               // Readable once the line has finished
+  JShellOutputFn cbs[2];
+  SessionBuffer *bufs[2];
+  void *user;
+} SessionDrain;
+
+
+/** Shell state is process-wide, so lines run one at a time */
+static pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * Append bytes to a buffer, keeping it NUL-terminated.
+ * Bytes that do not fit after a failed allocation are dropped.
+ * @param buf Buffer to grow.
+ * @param data Bytes to append.
+ * @param len Number of bytes.
+ */
+static void buffer_append(SessionBuffer *buf, const char *data, size_t len) {
+  if (buf->len + len + 1 > buf->cap) {
+    size_t new_cap = buf->cap ? buf->cap : 4096;
+    while (new_cap < buf->len + len + 1) {
+      new_cap *= 2;
+    }
+    char *grown = realloc(buf->data, new_cap);
+    if (grown == NULL) {
+      return;
+    }
+    buf->data = grown;
+    buf->cap = new_cap;
+  }
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+  buf->data[buf->len] = '\0';
+}
+
+
+/**
+ * Read whatever a capture pipe holds and deliver it.
+ * @param drain Drain state.
+ * @param stream 0 for stdout, 1 for stderr.
+ * @param chunk Scratch buffer of SESSION_READ_CHUNK bytes.
+ */
+static void drain_pipe(SessionDrain *drain, int stream, char *chunk) {
+  while (drain->fds[stream] >= 0) {
+    ssize_t n = read(drain->fds[stream], chunk, SESSION_READ_CHUNK);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      if (n == 0) {
+        drain->fds[stream] = -1;  // Closed by the caller afterwards
+      }
+      return;
+    }
+    if (drain->cbs[stream] != NULL) {
+      drain->cbs[stream](chunk, (size_t)n, drain->user);
+    } else {
+      buffer_append(drain->bufs[stream], chunk, (size_t)n);
+    }
+  }
+}
+
+
+/**
+ * Drain thread: deliver output until the line has finished, then pick up
+ * what is left in the pipes without waiting for background jobs that
+ * still hold their write ends.
+ * @param arg SessionDrain.
+ * @return NULL.
+ */
+static void *drain_thread(void *arg) {
+  SessionDrain *drain = arg;
+  char *chunk = malloc(SESSION_READ_CHUNK);
+  if (chunk == NULL) {
+    return NULL;
+  }
+
+  bool stopping = false;
+  while (!stopping) {
+    struct pollfd fds[3] = {
+      { .fd = drain->fds[0], .events = POLLIN },
+      { .fd = drain->fds[1], .events = POLLIN },
+      { .fd = drain->stop_fd, .events = POLLIN },
+    };
+    if (poll(fds, 3, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    stopping = fds[2].revents != 0;
+    for (int stream = 0; stream < 2; stream++) {
+      if (fds[stream].revents != 0 || stopping) {
+        drain_pipe(drain, stream, chunk);
+      }
+    }
+  }
+
+  free(chunk);
+  return NULL;
+}
+
+
+JShellSession *jshell_session_new(void) {
+  static const int host_signals[] = { SIGINT, SIGTERM, SIGHUP };
+  struct sigaction saved[3];
+
+  for (size_t i = 0; i < 3; i++) {
+    sigaction(host_signals[i], NULL, &saved[i]);
+  }
+  jshell_init_shell();
+  for (size_t i = 0; i < 3; i++) {
+    sigaction(host_signals[i], &saved[i], NULL);
+  }
+
+  JShellSession *session = calloc(1, sizeof(*session));
+  if (session == NULL) {
+    return NULL;
+  }
+  session->cwd = jshell_cwd_ref(jshell_cwd_current());
+  if (session->cwd == NULL) {
+    free(session);
+    return NULL;
+  }
+  return session;
+}
+
+
+int jshell_session_exec(JShellSession *session, const char *line,
+                        JShellOutputFn out_cb, JShellOutputFn err_cb,
+                        void *user) {
+  if (session == NULL || line == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  pthread_mutex_lock(&session_lock);
+
+  SessionBuffer *bufs[] = { &session->out, &session->err };
+  for (size_t i = 0; i < 2; i++) {
+    bufs[i]->len = 0;
+    if (bufs[i]->data != NULL) {
+      bufs[i]->data[0] = '\0';
+    }
+  }
+
+  int out_pipe[2] = { -1, -1 };
+  int err_pipe[2] = { -1, -1 };
+  int stop_pipe[2] = { -1, -1 };
+  int saved_out = -1;
+  int saved_err = -1;
+  int status = -1;
+  int err = 0;
+
+  if (pipe2(out_pipe, O_CLOEXEC) != 0 || pipe2(err_pipe, O_CLOEXEC) != 0
+      || pipe2(stop_pipe, O_CLOEXEC) != 0
+      || (saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3)) < 0
+      || (saved_err = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 3)) < 0) {
+    err = errno;
+    goto done;
+  }
+  fcntl(out_pipe[0], F_SETFL, O_NONBLOCK);
+  fcntl(err_pipe[0], F_SETFL, O_NONBLOCK);
+
+  SessionDrain drain = {
+    .fds = { out_pipe[0], err_pipe[0] },
+    .stop_fd = stop_pipe[0],
+    .cbs = { out_cb, err_cb },
+    .bufs = { bufs[0], bufs[1] },
+    .user = user,
+  };
+  pthread_t thread;
+  err = pthread_create(&thread, NULL, drain_thread, &drain);
+  if (err != 0) {
+    goto done;
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+  dup2(out_pipe[1], STDOUT_FILENO);
+  dup2(err_pipe[1], STDERR_FILENO);
+  close(out_pipe[1]);
+  close(err_pipe[1]);
+  out_pipe[1] = err_pipe[1] = -1;
+
+  /* The line runs in the session's directory and may cd elsewhere */
+  JShellCwd *saved_cwd = jshell_cwd_swap_shell(jshell_cwd_ref(session->cwd));
+  status = jshell_exec_string(line);
+  if (saved_cwd != NULL) {
+    jshell_cwd_unref(session->cwd);
+    session->cwd = jshell_cwd_swap_shell(saved_cwd);
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+  dup2(saved_out, STDOUT_FILENO);
+  dup2(saved_err, STDERR_FILENO);
+
+  ssize_t n;
+  do {
+    n = write(stop_pipe[1], "", 1);
+  } while (n < 0 && errno == EINTR);
+  pthread_join(thread, NULL);
+
+done:
+  int fds[] = { out_pipe[0], out_pipe[1], err_pipe[0], err_pipe[1],
+                stop_pipe[0], stop_pipe[1], saved_out, saved_err };
+  for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+    if (fds[i] >= 0) {
+      close(fds[i]);
+    }
+  }
+
+  pthread_mutex_unlock(&session_lock);
+
+  if (status < 0) {
+    errno = err;
+  }
+  return status;
+}
+
+
+const char *jshell_session_stdout(const JShellSession *session, size_t *len) {
+  if (len != NULL) {
+    *len = session->out.len;
+  }
+  return session->out.data != NULL ? session->out.data : "";
+}
+
+
+const char *jshell_session_stderr(const JShellSession *session, size_t *len) {
+  if (len != NULL) {
+    *len = session->err.len;
+  }
+  return session->err.data != NULL ? session->err.data : "";
+}
+
+
+void jshell_session_free(JShellSession *session) {
+  if (session == NULL) {
+    return;
+  }
+  jshell_cwd_unref(session->cwd);
+  free(session->out.data);
+  free(session->err.data);
+  free(session);
+}
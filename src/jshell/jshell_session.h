@@ -0,0 +1,49 @@
+#ifndef JSHELL_SESSION_H
+#define JSHELL_SESSION_H
+
+#include <stddef.h>
+
+
+// Embedding API of libjshell (make libjshell): a host process runs shell
+// command lines in-process, through the same parse cache and executor as
+// `jshell -c`, and gets their output back without spawning a shell.
+//
+// The shell's state (variables, job table, signal setup, standard
+// descriptors) is process-wide, so commands of all sessions run one at a
+// time and every call must come from the same host thread. A session
+// keeps its own working directory; variables are shared by all sessions.
+typedef struct JShellSession JShellSession;
+
+// Receives a chunk of a command's output. Called on a helper thread,
+// never concurrently with itself, and always before
+// jshell_session_exec() returns. fds 1 and 2 are the capture pipes
+// meanwhile, so it must not write to the host's stdout or stderr
+typedef void (*JShellOutputFn)(const char* data, size_t len, void* user);
+
+
+// Create a session starting in the process's working directory
+// The shell is initialized on the first call; the host keeps its own
+// SIGINT, SIGTERM and SIGHUP handlers, SIGPIPE is ignored from then on
+// Returns NULL with errno set on failure
+JShellSession* jshell_session_new(void);
+
+// Run line with its standard output and error captured
+// Output goes to out_cb/err_cb as it is produced, or, for a NULL
+// callback, into the session's buffer for that stream (see below)
+// Output written by background jobs after the line finished is dropped
+// Returns the exit status of the line, or -1 with errno set if it could
+// not be run
+int jshell_session_exec(JShellSession* session, const char* line,
+                        JShellOutputFn out_cb, JShellOutputFn err_cb,
+                        void* user);
+
+// Output the last exec collected for a NULL callback, NUL-terminated
+// Valid until the next exec or free on the session; never NULL
+const char* jshell_session_stdout(const JShellSession* session, size_t* len);
+const char* jshell_session_stderr(const JShellSession* session, size_t* len);
+
+// Free a session (NULL is ignored); the shell stays initialized
+void jshell_session_free(JShellSession* session);
+
+
+#endif
@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <unistd.h>
 
 #include "jshell_signals.h"
@@ -22,6 +23,12 @@ volatile sig_atomic_t jshell_received_sigterm = 0;
 /** Global flag set by SIGHUP handler - volatile for signal safety. */
 volatile sig_atomic_t jshell_received_sighup = 0;
 
+/** Cancel flag of the background job running on this thread, if any. */
+static thread_local const atomic_bool* t_job_cancelled = NULL;
+
+/** Cancel flag of the pipeline stage running on this thread, if any. */
+static thread_local const atomic_bool* t_stage_cancelled = NULL;
+
 
 /**
  * SIGINT handler - sets interrupted flag.
@@ -100,6 +107,25 @@ void jshell_init_signals(void) {
 }
 
 
+/** Signals whose disposition the shell changes; children get defaults. */
+static const int CHILD_DEFAULT_SIGNALS[] = {
+  SIGINT, SIGTERM, SIGHUP, SIGPIPE, SIGCHLD, SIGTSTP, SIGTTIN, SIGTTOU
+};
+
+
+/**
+ * Fill a signal set with the signals reset to default in child processes.
+ * Used by launch paths that cannot run code in the child (posix_spawn).
+ * @param set Signal set to initialize.
+ */
+void jshell_child_default_signals(sigset_t* set) {
+  sigemptyset(set);
+  for (size_t i = 0; i < sizeof(CHILD_DEFAULT_SIGNALS) / sizeof(int); i++) {
+    sigaddset(set, CHILD_DEFAULT_SIGNALS[i]);
+  }
+}
+
+
 /**
  * Reset all signal handlers to default for child processes.
  * Called after fork() before exec() to restore normal signal behavior.
@@ -115,14 +141,9 @@ void jshell_reset_signals_for_child(void) {
   sa.sa_flags = 0;
 
   /* Reset all signals we've modified to default */
-  sigaction(SIGINT, &sa, NULL);
-  sigaction(SIGTERM, &sa, NULL);
-  sigaction(SIGHUP, &sa, NULL);
-  sigaction(SIGPIPE, &sa, NULL);
-  sigaction(SIGCHLD, &sa, NULL);
-  sigaction(SIGTSTP, &sa, NULL);
-  sigaction(SIGTTIN, &sa, NULL);
-  sigaction(SIGTTOU, &sa, NULL);
+  for (size_t i = 0; i < sizeof(CHILD_DEFAULT_SIGNALS) / sizeof(int); i++) {
+    sigaction(CHILD_DEFAULT_SIGNALS[i], &sa, NULL);
+  }
 
   /* Clear any pending signal masks */
   sigset_t empty_mask;
@@ -175,13 +196,58 @@ bool jshell_check_interrupted(void) {
 
 /**
  * Check if SIGINT was received without clearing the flag.
+ * On the thread of a background job, SIGINT is meant for the foreground
+ * and only `kill` of the job counts. A pipeline stage also stops once it
+ * is cancelled.
  * @return true if interrupted, false otherwise.
  */
 bool jshell_is_interrupted(void) {
+  if (t_stage_cancelled != NULL && atomic_load(t_stage_cancelled)) {
+    return true;
+  }
+  if (t_job_cancelled != NULL) {
+    return atomic_load(t_job_cancelled);
+  }
   return jshell_interrupted != 0;
 }
 
 
+/**
+ * Make this thread part of a background job.
+ * @param cancelled The job's cancel flag, or NULL to leave the job.
+ */
+void jshell_set_thread_cancel_flag(const atomic_bool* cancelled) {
+  t_job_cancelled = cancelled;
+}
+
+
+/**
+ * Get the cancel flag of the background job this thread belongs to.
+ * @return The flag, or NULL on foreground threads.
+ */
+const atomic_bool* jshell_get_thread_cancel_flag(void) {
+  return t_job_cancelled;
+}
+
+
+/**
+ * Make this thread run a pipeline stage.
+ * @param cancelled The stage's cancel flag, or NULL when the stage ends.
+ */
+void jshell_set_thread_stage_flag(const atomic_bool* cancelled) {
+  t_stage_cancelled = cancelled;
+}
+
+
+/**
+ * Get the cancel flag of the pipeline stage running on this thread.
+ * @return The flag, or NULL outside pipeline stages.
+ */
+const atomic_bool* jshell_get_thread_stage_flag(void) {
+  return t_stage_cancelled;
+}
+
+
 /**
  * Clear the interrupted flag.
  */
@@ -2,6 +2,7 @@
 #define JSHELL_SIGNALS_H
 
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 
 /**
@@ -26,6 +27,14 @@ void jshell_init_signals(void);
  */
 void jshell_reset_signals_for_child(void);
 
+/**
+ * Fill set with the signals jshell_reset_signals_for_child() resets.
+ * Lets posix_spawn() apply the same defaults via POSIX_SPAWN_SETSIGDEF.
+ *
+ * @param set Signal set to initialize
+ */
+void jshell_child_default_signals(sigset_t* set);
+
 /**
  * Block signals that could interfere with critical sections.
  * Blocks SIGINT and SIGCHLD. Saves previous mask in oldmask.
@@ -62,6 +71,38 @@ bool jshell_is_interrupted(void);
  */
 void jshell_clear_interrupted(void);
 
+/**
+ * Tie the calling thread to a background job, so jshell_is_interrupted()
+ * on it reports the job being killed instead of SIGINT.
+ *
+ * @param cancelled The job's cancel flag, or NULL for none
+ */
+void jshell_set_thread_cancel_flag(const atomic_bool *cancelled);
+
+/**
+ * Get the cancel flag set by jshell_set_thread_cancel_flag(), so threads
+ * a background builtin starts can share it.
+ *
+ * @return The flag, or NULL outside background jobs
+ */
+const atomic_bool *jshell_get_thread_cancel_flag(void);
+
+/**
+ * Tie the calling thread to a pipeline stage, so jshell_is_interrupted()
+ * on it also reports the stage being cancelled (its output has no reader
+ * any more, or the pipeline got SIGINT).
+ *
+ * @param cancelled The stage's cancel flag, or NULL for none
+ */
+void jshell_set_thread_stage_flag(const atomic_bool *cancelled);
+
+/**
+ * Get the flag set by jshell_set_thread_stage_flag().
+ *
+ * @return The flag, or NULL outside pipeline stages
+ */
+const atomic_bool *jshell_get_thread_stage_flag(void);
+
 /**
  * Check if shell received SIGTERM.
  *
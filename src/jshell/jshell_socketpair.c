@@ -3,8 +3,10 @@
  * @brief Pipe and socketpair creation utilities for inter-process communication.
  */
 
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/socket.h>
 
@@ -12,8 +14,48 @@
 #include "utils/jbox_utils.h"
 
 
+/**
+ * Get the capacity regular pipes are grown to.
+ * Read from JSHELL_PIPE_SIZE the first time, which is on the main thread
+ * while the first pipeline is set up.
+ * @return Capacity in bytes, or 0 to keep the kernel default.
+ */
+int jshell_pipe_capacity(void) {
+  static int capacity = -1;
+
+  if (capacity >= 0) {
+    return capacity;
+  }
+
+  capacity = JSHELL_PIPE_SIZE_DEFAULT;
+  const char* value = getenv("JSHELL_PIPE_SIZE");
+  if (value != NULL && *value != '\0') {
+    char* end;
+    long long size = strtoll(value, &end, 10);
+    if (*end == 'k' || *end == 'K') {
+      size *= 1024;
+      end++;
+    } else if (*end == 'm' || *end == 'M') {
+      size *= 1024 * 1024;
+      end++;
+    }
+    if (*end == '\0' && size >= 0 && size <= 1024 * 1024 * 1024) {
+      capacity = (int)size;
+    } else {
+      fprintf(stderr, "jshell: ignoring invalid JSHELL_PIPE_SIZE '%s'\n",
+              value);
+    }
+  }
+  return capacity;
+}
+
+
 /**
  * Create a pipe or socketpair for inter-process communication.
+ * Both ends are close-on-exec. Regular pipes are grown to
+ * jshell_pipe_capacity() so bulk stages context-switch less; if the
+ * kernel refuses (above fs.pipe-max-size, or past the user's pipe
+ * budget) the pipe keeps its default size.
  * @param p Pointer to JShellPipe structure to initialize.
  * @param use_socketpair If true, create socketpair; otherwise create pipe.
  * @return 0 on success, -1 on failure.
@@ -26,20 +68,26 @@ int jshell_create_pipe(JShellPipe* p, bool use_socketpair) {
   p->read_fd = -1;
   p->write_fd = -1;
   p->is_socketpair = use_socketpair;
+  p->read_ring = NULL;
+  p->write_ring = NULL;
 
   int fds[2];
 
   if (use_socketpair) {
-    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1) {
       perror("socketpair");
       return -1;
     }
     DPRINT("Created socketpair: read_fd=%d, write_fd=%d", fds[0], fds[1]);
   } else {
-    if (pipe(fds) == -1) {
+    if (pipe2(fds, O_CLOEXEC) == -1) {
       perror("pipe");
       return -1;
     }
+    int capacity = jshell_pipe_capacity();
+    if (capacity > 0) {
+      fcntl(fds[1], F_SETPIPE_SZ, capacity);
+    }
     DPRINT("Created pipe: read_fd=%d, write_fd=%d", fds[0], fds[1]);
   }
 
@@ -50,6 +98,34 @@ int jshell_create_pipe(JShellPipe* p, bool use_socketpair) {
 }
 
 
+/**
+ * Create a ring pipe for two builtins running on threads of the shell.
+ * Data then moves with memcpy instead of two copies through the kernel.
+ * @param p Pointer to JShellPipe structure to initialize.
+ * @return 0 on success, -1 on failure.
+ */
+int jshell_create_ring_pipe(JShellPipe* p) {
+  if (p == NULL) {
+    return -1;
+  }
+
+  p->read_fd = -1;
+  p->write_fd = -1;
+  p->is_socketpair = false;
+
+  JShellRing* ring = jshell_ring_create((size_t)jshell_pipe_capacity());
+  if (ring == NULL) {
+    p->read_ring = NULL;
+    p->write_ring = NULL;
+    return -1;
+  }
+  p->read_ring = ring;
+  p->write_ring = ring;
+
+  return 0;
+}
+
+
 /**
  * Close both ends of a pipe.
  * @param p Pointer to JShellPipe to close.
@@ -77,6 +153,10 @@ void jshell_close_pipe_read(JShellPipe* p) {
     close(p->read_fd);
     p->read_fd = -1;
   }
+  if (p->read_ring != NULL) {
+    jshell_ring_close_reader(p->read_ring);
+    p->read_ring = NULL;
+  }
 }
 
 
@@ -93,4 +173,8 @@ void jshell_close_pipe_write(JShellPipe* p) {
     close(p->write_fd);
     p->write_fd = -1;
   }
+  if (p->write_ring != NULL) {
+    jshell_ring_close_writer(p->write_ring);
+    p->write_ring = NULL;
+  }
 }
@@ -3,21 +3,43 @@
 
 #include <stdbool.h>
 
+#include "jshell_ring.h"
+
+
+// Capacity pipes to and from forked stages are grown to, unless the
+// JSHELL_PIPE_SIZE environment variable says otherwise (bytes, with an
+// optional K or M suffix; 0 keeps the kernel default of 64K)
+#define JSHELL_PIPE_SIZE_DEFAULT (1024 * 1024)
 
 // Pipe structure for inter-process/thread communication
+// A ring pipe has no descriptors: its ends are read_ring/write_ring until
+// handed to the stages, which reach it through streams
 typedef struct {
   int read_fd;
   int write_fd;
   bool is_socketpair;  // true for builtin-builtin, false for regular pipe
+  JShellRing* read_ring;   // Unclaimed read end of a ring pipe, or NULL
+  JShellRing* write_ring;  // Unclaimed write end of a ring pipe, or NULL
 } JShellPipe;
 
 
 // Create a pipe for command communication
 // use_socketpair: true for builtin-to-builtin (bidirectional)
 //                 false for regular pipe (unidirectional)
+// Both ends are close-on-exec, so children inherit only the ends they
+// dup2() onto their standard streams; regular pipes are grown to
+// jshell_pipe_capacity() where the kernel allows it
 // Returns 0 on success, -1 on failure
 int jshell_create_pipe(JShellPipe* p, bool use_socketpair);
 
+// Create an in-process ring pipe between two builtins running on threads,
+// of jshell_pipe_capacity() bytes
+// Returns 0 on success, -1 on failure
+int jshell_create_ring_pipe(JShellPipe* p);
+
+// Capacity regular pipes are grown to, in bytes (0 for the kernel default)
+int jshell_pipe_capacity(void);
+
 // Close both ends of a pipe
 void jshell_close_pipe(JShellPipe* p);
 
@@ -0,0 +1,283 @@
+/**
+ * @file jshell_spawn.c
+ * @brief Launching external commands via posix_spawn with a fork fallback.
+ *
+ * The shell process is large (ASan, libcurl), so fork() has to copy a big
+ * page table for every external command. posix_spawn() lets the C library
+ * use a vfork-style clone instead; redirections and signal defaults are
+ * expressed as file actions and spawn attributes, so no shell code has to
+ * run in the child. fork() is only used where posix_spawn is unavailable
+ * or cannot express the launch, such as a child started from a builtin
+ * thread whose working directory is not the process's.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+
+#if defined(_POSIX_SPAWN) && _POSIX_SPAWN > 0
+#define JSHELL_HAVE_POSIX_SPAWN 1
+#include <spawn.h>
+#endif
+
+#include "jshell_spawn.h"
+#include "jshell_cwd.h"
+#include "jshell_signals.h"
+#include "jshell_stats.h"
+#include "jshell_trace.h"
+#include "jshell_vars.h"
+#include "utils/jbox_utils.h"
+
+
+extern char** environ;
+
+
+/**
+ * Print the error for a command that could not be executed.
+ * @param name Command name (argv[0]).
+ * @param err errno from the failed exec.
+ * @param searched_path true if the command was looked up through PATH.
+ * @return Shell exit status for the failure (126 or 127).
+ */
+static int report_exec_failure(const char* name, int err,
+                               bool searched_path) {
+  if (err == EACCES) {
+    fprintf(stderr, "jshell: %s: Permission denied\n", name);
+    return 126;
+  }
+  if (err == ENOENT && searched_path) {
+    fprintf(stderr, "jshell: %s: command not found\n", name);
+  } else {
+    fprintf(stderr, "jshell: %s: %s\n", name, strerror(err));
+  }
+  return 127;
+}
+
+
+/**
+ * Launch a command with fork() and exec, the portable slow path.
+ * @param cwd_fd Directory the child enters first, or -1 to stay.
+ * @return Child pid, or -1 if fork() failed.
+ */
+static pid_t fork_command(const char* exec_path, char* const argv[],
+                          int stdin_fd, int stdout_fd,
+                          const int* close_fds, size_t close_count,
+                          int cwd_fd) {
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    return -1;
+  }
+  if (pid > 0) {
+    jshell_stats_add(JSHELL_STAT_FORKS, 1);
+    return pid;
+  }
+
+  jshell_reset_signals_for_child();
+
+  if (cwd_fd != -1 && fchdir(cwd_fd) == -1) {
+    perror("jshell: fchdir");
+    _exit(EXIT_FAILURE);
+  }
+  if (stdin_fd != -1 && stdin_fd != STDIN_FILENO) {
+    if (dup2(stdin_fd, STDIN_FILENO) == -1) {
+      perror("dup2 input");
+      _exit(EXIT_FAILURE);
+    }
+  }
+  if (stdout_fd != -1 && stdout_fd != STDOUT_FILENO) {
+    if (dup2(stdout_fd, STDOUT_FILENO) == -1) {
+      perror("dup2 output");
+      _exit(EXIT_FAILURE);
+    }
+  }
+  if (stdin_fd > STDERR_FILENO) {
+    close(stdin_fd);
+  }
+  if (stdout_fd > STDERR_FILENO) {
+    close(stdout_fd);
+  }
+  for (size_t i = 0; i < close_count; i++) {
+    if (close_fds[i] > STDERR_FILENO) {
+      close(close_fds[i]);
+    }
+  }
+
+  if (exec_path != NULL) {
+    execv(exec_path, argv);
+  } else {
+    execvp(argv[0], argv);
+  }
+  _exit(report_exec_failure(argv[0], errno, exec_path == NULL));
+}
+
+
+#ifdef JSHELL_HAVE_POSIX_SPAWN
+/**
+ * Check whether a descriptor should be closed in the child.
+ * Standard streams and descriptors already listed are skipped.
+ * @param fds Close list.
+ * @param index Position of the candidate in the list.
+ * @return true if fds[index] needs its own close action.
+ */
+static bool needs_close(const int* fds, size_t index) {
+  if (fds[index] <= STDERR_FILENO) {
+    return false;
+  }
+  for (size_t i = 0; i < index; i++) {
+    if (fds[i] == fds[index]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+/**
+ * Fill in the file actions that redirect and close the child's fds.
+ * @return 0 on success, or an error number.
+ */
+static int build_file_actions(posix_spawn_file_actions_t* actions,
+                              int stdin_fd, int stdout_fd,
+                              const int* close_fds, size_t close_count) {
+  int err = 0;
+
+  if (stdin_fd != -1 && stdin_fd != STDIN_FILENO) {
+    err = posix_spawn_file_actions_adddup2(actions, stdin_fd, STDIN_FILENO);
+  }
+  if (err == 0 && stdout_fd != -1 && stdout_fd != STDOUT_FILENO) {
+    err = posix_spawn_file_actions_adddup2(actions, stdout_fd,
+                                           STDOUT_FILENO);
+  }
+  if (err == 0 && stdin_fd > STDERR_FILENO) {
+    err = posix_spawn_file_actions_addclose(actions, stdin_fd);
+  }
+  if (err == 0 && stdout_fd > STDERR_FILENO && stdout_fd != stdin_fd) {
+    err = posix_spawn_file_actions_addclose(actions, stdout_fd);
+  }
+  for (size_t i = 0; err == 0 && i < close_count; i++) {
+    if (needs_close(close_fds, i) && close_fds[i] != stdin_fd
+        && close_fds[i] != stdout_fd) {
+      err = posix_spawn_file_actions_addclose(actions, close_fds[i]);
+    }
+  }
+
+  return err;
+}
+
+
+/**
+ * Fill in attributes that give the child default signal handling.
+ * @return 0 on success, or an error number.
+ */
+static int build_spawn_attr(posix_spawnattr_t* attr) {
+  sigset_t defaults;
+  sigset_t empty_mask;
+
+  jshell_child_default_signals(&defaults);
+  sigemptyset(&empty_mask);
+
+  int err = posix_spawnattr_setsigdefault(attr, &defaults);
+  if (err == 0) {
+    err = posix_spawnattr_setsigmask(attr, &empty_mask);
+  }
+  if (err == 0) {
+    err = posix_spawnattr_setflags(attr, POSIX_SPAWN_SETSIGDEF
+                                         | POSIX_SPAWN_SETSIGMASK);
+  }
+
+  return err;
+}
+#endif
+
+
+/**
+ * Launch an external command; see jshell_spawn_command().
+ * @return Child pid, or -1 on failure.
+ */
+static pid_t spawn_command(const char* exec_path, char* const argv[],
+                           int stdin_fd, int stdout_fd,
+                           const int* close_fds, size_t close_count,
+                           int* failure_status) {
+  *failure_status = 127;
+  int cwd_fd = jshell_cwd_child_fd();
+
+#ifdef JSHELL_HAVE_POSIX_SPAWN
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  bool have_actions = posix_spawn_file_actions_init(&actions) == 0;
+  bool have_attr = posix_spawnattr_init(&attr) == 0;
+  int err = -1;
+
+  if (cwd_fd == -1 && have_actions && have_attr
+      && build_file_actions(&actions, stdin_fd, stdout_fd,
+                            close_fds, close_count) == 0
+      && build_spawn_attr(&attr) == 0) {
+    pid_t pid;
+    if (exec_path != NULL) {
+      err = posix_spawn(&pid, exec_path, &actions, &attr, argv, environ);
+    } else {
+      err = posix_spawnp(&pid, argv[0], &actions, &attr, argv, environ);
+    }
+    if (err == 0) {
+      DPRINT("Spawned %s as pid %d", argv[0], pid);
+      jshell_stats_add(JSHELL_STAT_SPAWNS, 1);
+      posix_spawn_file_actions_destroy(&actions);
+      posix_spawnattr_destroy(&attr);
+      return pid;
+    }
+  }
+
+  if (have_actions) {
+    posix_spawn_file_actions_destroy(&actions);
+  }
+  if (have_attr) {
+    posix_spawnattr_destroy(&attr);
+  }
+
+  if (err > 0 && !(err == ENOEXEC && exec_path == NULL)) {
+    *failure_status = report_exec_failure(argv[0], err, exec_path == NULL);
+    return -1;
+  }
+  DPRINT("posix_spawn unusable for %s, falling back to fork", argv[0]);
+#endif
+
+  return fork_command(exec_path, argv, stdin_fd, stdout_fd,
+                      close_fds, close_count, cwd_fd);
+}
+
+
+/**
+ * Launch an external command without running shell code in the child.
+ *
+ * Uses posix_spawn() when available. Falls back to fork() if the spawn
+ * attributes cannot be set up, or for an unresolved command whose file
+ * is not a binary (ENOEXEC), which execvp() hands to /bin/sh.
+ *
+ * @param exec_path Path resolved by the parent, or NULL to search PATH.
+ * @param argv Argument vector of the command.
+ * @param stdin_fd Descriptor for the child's stdin, or -1 to inherit.
+ * @param stdout_fd Descriptor for the child's stdout, or -1 to inherit.
+ * @param close_fds Extra descriptors to close in the child, or NULL.
+ * @param close_count Number of entries in close_fds.
+ * @param failure_status Set to 126/127 when the command cannot be run.
+ * @return Child pid, or -1 on failure.
+ */
+pid_t jshell_spawn_command(const char* exec_path, char* const argv[],
+                           int stdin_fd, int stdout_fd,
+                           const int* close_fds, size_t close_count,
+                           int* failure_status) {
+  jshell_vars_sync_environ();
+
+  /* posix_spawn() returns once the child has exec'd, so this covers both */
+  uint64_t trace_start = jshell_trace_begin();
+  pid_t pid = spawn_command(exec_path, argv, stdin_fd, stdout_fd,
+                            close_fds, close_count, failure_status);
+  jshell_trace_end("spawn", argv[0], trace_start);
+  return pid;
+}
@@ -0,0 +1,20 @@
+#ifndef JSHELL_SPAWN_H
+#define JSHELL_SPAWN_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+
+// Launch an external command without running shell code in the child
+// exec_path: path resolved by the parent, or NULL to search PATH
+// stdin_fd/stdout_fd: descriptors installed as fd 0/1, or -1 to inherit
+// close_fds: extra descriptors the child must not inherit (may be NULL)
+// Returns the child's pid; on failure returns -1 and sets *failure_status
+// to the shell status for the command (126 or 127), error already printed
+pid_t jshell_spawn_command(const char* exec_path, char* const argv[],
+                           int stdin_fd, int stdout_fd,
+                           const int* close_fds, size_t close_count,
+                           int* failure_status);
+
+
+#endif
@@ -0,0 +1,367 @@
+/**
+ * @file jshell_spool.c
+ * @brief Bounded in-memory output of background jobs.
+ *
+ * In an interactive session, a background job whose output would go to
+ * the terminal writes into a pipe instead. One helper thread waits on
+ * the read ends of all such pipes with epoll and copies whatever arrives
+ * into each job's ring, overwriting the oldest bytes once it is full, so
+ * a job never blocks on a slow or vanished terminal and memory stays
+ * bounded however much it prints. `jobs --output` reads the ring at any
+ * time; the shell prints it when the job is reported done or collected
+ * by `wait`.
+ *
+ * Spools are only touched under one lock. The owner frees a spool whose
+ * pipe has closed itself; otherwise it only marks it released and wakes
+ * the thread, which stops watching it and frees it, so the thread never
+ * sees a spool freed behind its back.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "jshell_spool.h"
+#include "jshell_vars.h"
+#include "utils/jbox_utils.h"
+
+
+/** Reads of one pipe per wakeup, so a chatty job cannot hog the lock */
+#define SPOOL_READS_PER_EVENT 16
+
+/** Events taken from epoll at a time */
+#define SPOOL_MAX_EVENTS 32
+
+
+struct JShellSpool {
+  int fd;               // Read end, or -1 once every writer has closed it
+  char* ring;
+  size_t cap;
+  size_t head;          // Where the next byte goes
+  size_t len;           // Bytes held, at most cap
+  uint64_t total;       // Bytes ever written
+  bool released;        // Freed by its owner; the thread frees it
+  struct JShellSpool* next;
+};
+
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_completed = PTHREAD_COND_INITIALIZER;
+static JShellSpool* g_spools = NULL;   // All spools, for sweeping
+static int g_epoll_fd = -1;
+static int g_wake_fd = -1;             // Registered with a NULL pointer
+static bool g_thread_started = false;
+static bool g_enabled = false;
+
+
+void jshell_spool_enable(void) {
+  g_enabled = true;
+}
+
+
+size_t jshell_spool_size(void) {
+  if (!g_enabled) {
+    return 0;
+  }
+  const char* value = jshell_var_get("JSHELL_JOB_OUTPUT");
+  if (value == NULL || *value == '\0') {
+    return JSHELL_SPOOL_DEFAULT_SIZE;
+  }
+
+  char* end;
+  long long size = strtoll(value, &end, 10);
+  if (*end == 'k' || *end == 'K') {
+    size *= 1024;
+    end++;
+  } else if (*end == 'm' || *end == 'M') {
+    size *= 1024 * 1024;
+    end++;
+  }
+  if (*end != '\0' || size < 0 || size > 1024LL * 1024 * 1024) {
+    fprintf(stderr, "jshell: ignoring invalid JSHELL_JOB_OUTPUT '%s'\n",
+            value);
+    return JSHELL_SPOOL_DEFAULT_SIZE;
+  }
+  return (size_t)size;
+}
+
+
+/**
+ * Stop watching a spool whose pipe has closed. Caller holds g_lock.
+ * @param spool Spool still holding its read end.
+ */
+static void spool_complete(JShellSpool* spool) {
+  epoll_ctl(g_epoll_fd, EPOLL_CTL_DEL, spool->fd, NULL);
+  close(spool->fd);
+  spool->fd = -1;
+  pthread_cond_broadcast(&g_completed);
+}
+
+
+/**
+ * Unlink a spool from the list and free it. Caller holds g_lock.
+ * @param spool Spool whose read end is closed.
+ */
+static void spool_destroy(JShellSpool* spool) {
+  for (JShellSpool** link = &g_spools; *link != NULL;
+       link = &(*link)->next) {
+    if (*link == spool) {
+      *link = spool->next;
+      break;
+    }
+  }
+  free(spool->ring);
+  free(spool);
+}
+
+
+/**
+ * Move what a pipe holds into its ring. Caller holds g_lock.
+ * @param spool Spool with data or a hangup pending.
+ */
+static void spool_drain(JShellSpool* spool) {
+  for (int i = 0; i < SPOOL_READS_PER_EVENT; i++) {
+    ssize_t n = read(spool->fd, spool->ring + spool->head,
+                     spool->cap - spool->head);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && errno == EAGAIN) {
+      return;
+    }
+    if (n <= 0) {
+      spool_complete(spool);
+      return;
+    }
+    spool->head = (spool->head + (size_t)n) % spool->cap;
+    spool->len = spool->len + (size_t)n < spool->cap
+                 ? spool->len + (size_t)n : spool->cap;
+    spool->total += (uint64_t)n;
+  }
+}
+
+
+/**
+ * Helper thread: drain pipes as data arrives and free released spools.
+ * @param arg Unused.
+ * @return NULL.
+ */
+static void* spool_thread(void* arg) {
+  (void)arg;
+  struct epoll_event events[SPOOL_MAX_EVENTS];
+
+  for (;;) {
+    int n = epoll_wait(g_epoll_fd, events, SPOOL_MAX_EVENTS, -1);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("jshell: spool");
+      return NULL;
+    }
+
+    pthread_mutex_lock(&g_lock);
+    for (int i = 0; i < n; i++) {
+      JShellSpool* spool = events[i].data.ptr;
+      if (spool == NULL) {
+        uint64_t count;
+        while (read(g_wake_fd, &count, sizeof(count)) > 0) {
+        }
+      } else if (spool->fd >= 0 && !spool->released) {
+        spool_drain(spool);
+      }
+    }
+
+    JShellSpool* spool = g_spools;
+    while (spool != NULL) {
+      JShellSpool* next = spool->next;
+      if (spool->released) {
+        if (spool->fd >= 0) {
+          spool_complete(spool);
+        }
+        spool_destroy(spool);
+      }
+      spool = next;
+    }
+    pthread_mutex_unlock(&g_lock);
+  }
+}
+
+
+/**
+ * In a forked child the helper thread is gone: keep what inherited
+ * spools hold, stop reading their pipes and start over on next use.
+ */
+static void spool_after_fork(void) {
+  pthread_mutex_init(&g_lock, NULL);
+  pthread_cond_init(&g_completed, NULL);
+  for (JShellSpool* spool = g_spools; spool != NULL; spool = spool->next) {
+    if (spool->fd >= 0) {
+      close(spool->fd);
+      spool->fd = -1;
+    }
+  }
+  if (g_epoll_fd >= 0) {
+    close(g_epoll_fd);
+    close(g_wake_fd);
+  }
+  g_epoll_fd = -1;
+  g_wake_fd = -1;
+  g_thread_started = false;
+}
+
+
+/**
+ * Start the helper thread unless it runs. Caller holds g_lock.
+ * @return 0 on success, -1 with errno set on failure.
+ */
+static int spool_start_thread(void) {
+  static bool atfork_registered = false;
+
+  if (g_thread_started) {
+    return 0;
+  }
+  if (!atfork_registered) {
+    pthread_atfork(NULL, NULL, spool_after_fork);
+    atfork_registered = true;
+  }
+
+  g_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  g_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  struct epoll_event wake = { .events = EPOLLIN, .data.ptr = NULL };
+  pthread_attr_t attr;
+  pthread_t thread;
+  int err = 0;
+  if (g_epoll_fd < 0 || g_wake_fd < 0
+      || epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, g_wake_fd, &wake) != 0) {
+    err = errno;
+  } else {
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    err = pthread_create(&thread, &attr, spool_thread, NULL);
+    pthread_attr_destroy(&attr);
+  }
+
+  if (err != 0) {
+    if (g_epoll_fd >= 0) close(g_epoll_fd);
+    if (g_wake_fd >= 0) close(g_wake_fd);
+    g_epoll_fd = -1;
+    g_wake_fd = -1;
+    errno = err;
+    return -1;
+  }
+  g_thread_started = true;
+  return 0;
+}
+
+
+JShellSpool* jshell_spool_open(size_t size, int* write_fd) {
+  JShellSpool* spool = calloc(1, sizeof(*spool));
+  char* ring = malloc(size > 0 ? size : 1);
+  int fds[2] = { -1, -1 };
+  if (spool == NULL || ring == NULL || pipe2(fds, O_CLOEXEC) != 0) {
+    int err = errno;
+    free(spool);
+    free(ring);
+    errno = err;
+    return NULL;
+  }
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  spool->fd = fds[0];
+  spool->ring = ring;
+  spool->cap = size > 0 ? size : 1;
+
+  pthread_mutex_lock(&g_lock);
+  struct epoll_event event = { .events = EPOLLIN, .data.ptr = spool };
+  if (spool_start_thread() != 0
+      || epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, spool->fd, &event) != 0) {
+    int err = errno;
+    pthread_mutex_unlock(&g_lock);
+    close(fds[0]);
+    close(fds[1]);
+    free(ring);
+    free(spool);
+    errno = err;
+    return NULL;
+  }
+  spool->next = g_spools;
+  g_spools = spool;
+  pthread_mutex_unlock(&g_lock);
+
+  DPRINT("Spooling job output through fd %d (%zu bytes)", fds[0], size);
+  *write_fd = fds[1];
+  return spool;
+}
+
+
+char* jshell_spool_read(JShellSpool* spool, size_t* len, uint64_t* dropped,
+                        bool* complete) {
+  pthread_mutex_lock(&g_lock);
+  char* data = malloc(spool->len + 1);
+  if (data != NULL) {
+    size_t start = (spool->head + spool->cap - spool->len) % spool->cap;
+    size_t first = spool->cap - start < spool->len ? spool->cap - start
+                                                   : spool->len;
+    memcpy(data, spool->ring + start, first);
+    memcpy(data + first, spool->ring, spool->len - first);
+    data[spool->len] = '\0';
+    if (len != NULL) {
+      *len = spool->len;
+    }
+    if (dropped != NULL) {
+      *dropped = spool->total - spool->len;
+    }
+    if (complete != NULL) {
+      *complete = spool->fd < 0;
+    }
+  }
+  pthread_mutex_unlock(&g_lock);
+  return data;
+}
+
+
+bool jshell_spool_wait(JShellSpool* spool, int timeout_ms) {
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += timeout_ms / 1000;
+  deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  pthread_mutex_lock(&g_lock);
+  while (spool->fd >= 0
+         && pthread_cond_timedwait(&g_completed, &g_lock, &deadline) == 0) {
+  }
+  bool complete = spool->fd < 0;
+  pthread_mutex_unlock(&g_lock);
+  return complete;
+}
+
+
+void jshell_spool_free(JShellSpool* spool) {
+  if (spool == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&g_lock);
+  if (spool->fd < 0) {
+    spool_destroy(spool);
+  } else {
+    spool->released = true;
+    uint64_t one = 1;
+    if (write(g_wake_fd, &one, sizeof(one)) < 0) {
+      DPRINT("Could not wake the spool thread: %s", strerror(errno));
+    }
+  }
+  pthread_mutex_unlock(&g_lock);
+}
@@ -0,0 +1,50 @@
+#ifndef JSHELL_SPOOL_H
+#define JSHELL_SPOOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+// Bytes of output kept per background job unless JSHELL_JOB_OUTPUT says
+// otherwise
+#define JSHELL_SPOOL_DEFAULT_SIZE (64 * 1024)
+
+
+// Output of a background job, kept in memory instead of going to the
+// terminal: the job writes into a pipe that a helper thread drains into
+// a ring of the last N bytes, so the job never waits for the terminal
+typedef struct JShellSpool JShellSpool;
+
+
+// Spool background jobs from now on; called by the interactive loop, as
+// scripts run no prompt at which finished jobs would be reported
+void jshell_spool_enable(void);
+
+// Bytes to keep per job, from the JSHELL_JOB_OUTPUT variable (bytes, or
+// with a K/M suffix); 0 means background jobs write to the terminal, as
+// they always do until jshell_spool_enable() is called
+size_t jshell_spool_size(void);
+
+// Create a spool keeping the last size bytes written to it
+// Sets *write_fd to the close-on-exec write end for the job's stdout;
+// the caller owns and closes it
+// Returns NULL with errno set on failure
+JShellSpool* jshell_spool_open(size_t size, int* write_fd);
+
+// Copy what the spool holds, NUL-terminated; caller frees
+// dropped (optional) gets the bytes overwritten because the ring was
+// full, complete (optional) whether every writer has closed the pipe
+// Returns NULL if out of memory
+char* jshell_spool_read(JShellSpool* spool, size_t* len, uint64_t* dropped,
+                        bool* complete);
+
+// Wait up to timeout_ms for every writer to close the pipe
+// Returns true if the spool is complete
+bool jshell_spool_wait(JShellSpool* spool, int timeout_ms);
+
+// Free a spool; writers still holding the pipe get EPIPE from then on
+void jshell_spool_free(JShellSpool* spool);
+
+
+#endif
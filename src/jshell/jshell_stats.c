@@ -0,0 +1,267 @@
+/**
+ * @file jshell_stats.c
+ * @brief Always-on runtime counters, one slot per thread.
+ *
+ * A thread claims a slot of a shared array on its first update and from
+ * then on is the only writer of it, so an update is a relaxed load and
+ * store on a cache line no other thread writes. A thread that ends adds
+ * its slot into the retired totals and frees it. Readers sum the retired
+ * totals and every slot in use; the result may be off by updates that
+ * race with the read, which is fine for monitoring.
+ *
+ * The array is an anonymous shared mapping, so processes forked from the
+ * shell (server connections, fork() fallbacks) count into the same
+ * totals. Their threads do not run slot destructors when the process
+ * exits, so when no slot is free, slots of processes that are gone are
+ * folded into the retired totals and reused. Reset does not touch other
+ * threads' slots; it records the current totals as a baseline that reads
+ * subtract.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "jshell_stats.h"
+
+
+/** Slots shared by all threads of the shell and its forks */
+#define STATS_SLOTS 1024
+
+/** Slot states */
+#define SLOT_FREE      0
+#define SLOT_USED      1
+#define SLOT_RECLAIMED 2   // Being folded into the retired totals
+
+
+/** Counters of one thread, on cache lines of their own */
+typedef struct {
+  _Alignas(64) _Atomic int state;
+  _Atomic int pid;
+  _Atomic uint64_t counters[JSHELL_STAT_COUNT];
+} JShellStatsSlot;
+
+
+typedef struct {
+  _Atomic uint64_t retired[JSHELL_STAT_COUNT];
+  _Atomic uint64_t baseline[JSHELL_STAT_COUNT];
+  JShellStatsSlot slots[STATS_SLOTS];
+} JShellStatsShared;
+
+
+static const char* const stat_names[JSHELL_STAT_COUNT] = {
+  [JSHELL_STAT_CMD_BUILTIN]    = "cmd_builtin",
+  [JSHELL_STAT_CMD_THREAD]     = "cmd_thread",
+  [JSHELL_STAT_CMD_EXTERNAL]   = "cmd_external",
+  [JSHELL_STAT_CMD_PACKAGE]    = "cmd_package",
+  [JSHELL_STAT_SPAWNS]         = "spawns",
+  [JSHELL_STAT_FORKS]          = "forks",
+  [JSHELL_STAT_PATH_HITS]      = "path_cache_hits",
+  [JSHELL_STAT_PATH_MISSES]    = "path_cache_misses",
+  [JSHELL_STAT_PARSE_HITS]     = "parse_cache_hits",
+  [JSHELL_STAT_PARSE_MISSES]   = "parse_cache_misses",
+  [JSHELL_STAT_RESULT_HITS]    = "result_cache_hits",
+  [JSHELL_STAT_RESULT_MISSES]  = "result_cache_misses",
+  [JSHELL_STAT_CAPTURES]       = "captures",
+  [JSHELL_STAT_CAPTURE_BYTES]  = "capture_bytes",
+  [JSHELL_STAT_AI_REQUESTS]    = "ai_requests",
+  [JSHELL_STAT_AI_ERRORS]      = "ai_errors",
+  [JSHELL_STAT_AI_LATENCY_US]  = "ai_latency_us",
+  [JSHELL_STAT_PKG_RELOADS]    = "pkg_reloads",
+};
+
+
+static JShellStatsShared* g_shared = NULL;
+static pthread_key_t g_slot_key;
+
+static thread_local JShellStatsSlot* t_slot = NULL;
+static thread_local bool t_no_slot = false;
+
+
+/**
+ * Add a slot's counts to the retired totals and clear it.
+ * The caller must own the slot (its thread, or a reclaimer holding it
+ * in SLOT_RECLAIMED).
+ * @param slot Slot to fold.
+ */
+static void fold_slot(JShellStatsSlot* slot) {
+  for (int i = 0; i < JSHELL_STAT_COUNT; i++) {
+    uint64_t n = atomic_load_explicit(&slot->counters[i],
+                                      memory_order_relaxed);
+    if (n != 0) {
+      atomic_fetch_add_explicit(&g_shared->retired[i], n,
+                                memory_order_relaxed);
+      atomic_store_explicit(&slot->counters[i], 0, memory_order_relaxed);
+    }
+  }
+}
+
+
+/**
+ * Thread exit: give the thread's slot back.
+ * @param arg The thread's slot.
+ */
+static void release_slot(void* arg) {
+  JShellStatsSlot* slot = arg;
+  fold_slot(slot);
+  atomic_store_explicit(&slot->pid, 0, memory_order_relaxed);
+  atomic_store_explicit(&slot->state, SLOT_FREE, memory_order_release);
+}
+
+
+/**
+ * In a forked child: the slot of the thread that forked belongs to the
+ * parent, so the child's thread claims one of its own on next use.
+ */
+static void stats_after_fork(void) {
+  t_slot = NULL;
+  t_no_slot = false;
+  pthread_setspecific(g_slot_key, NULL);
+}
+
+
+/**
+ * Claim a slot for the calling thread, reclaiming slots of exited
+ * processes when none is free.
+ * @return The slot, or NULL if all are in use.
+ */
+static JShellStatsSlot* claim_slot(void) {
+  JShellStatsSlot* slot = NULL;
+
+  for (int i = 0; i < STATS_SLOTS && slot == NULL; i++) {
+    int expected = SLOT_FREE;
+    if (atomic_compare_exchange_strong(&g_shared->slots[i].state,
+                                       &expected, SLOT_USED)) {
+      slot = &g_shared->slots[i];
+    }
+  }
+
+  for (int i = 0; i < STATS_SLOTS && slot == NULL; i++) {
+    JShellStatsSlot* candidate = &g_shared->slots[i];
+    pid_t pid = atomic_load_explicit(&candidate->pid, memory_order_relaxed);
+    if (pid == 0 || kill(pid, 0) == 0 || errno != ESRCH) {
+      continue;
+    }
+    int expected = SLOT_USED;
+    if (atomic_compare_exchange_strong(&candidate->state,
+                                       &expected, SLOT_RECLAIMED)) {
+      fold_slot(candidate);
+      atomic_store_explicit(&candidate->state, SLOT_USED,
+                            memory_order_release);
+      slot = candidate;
+    }
+  }
+
+  if (slot != NULL) {
+    atomic_store_explicit(&slot->pid, getpid(), memory_order_relaxed);
+    pthread_setspecific(g_slot_key, slot);
+  }
+  return slot;
+}
+
+
+void jshell_stats_init(void) {
+  if (g_shared != NULL) {
+    return;
+  }
+  void* shared = mmap(NULL, sizeof(JShellStatsShared),
+                      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                      -1, 0);
+  if (shared == MAP_FAILED) {
+    perror("jshell: stats");
+    return;
+  }
+  if (pthread_key_create(&g_slot_key, release_slot) != 0) {
+    munmap(shared, sizeof(JShellStatsShared));
+    return;
+  }
+  pthread_atfork(NULL, NULL, stats_after_fork);
+  g_shared = shared;
+}
+
+
+void jshell_stats_add(JShellStat stat, uint64_t n) {
+  JShellStatsSlot* slot = t_slot;
+  if (slot == NULL) {
+    if (g_shared == NULL) {
+      return;
+    }
+    if (!t_no_slot) {
+      slot = t_slot = claim_slot();
+      t_no_slot = slot == NULL;
+    }
+    if (slot == NULL) {
+      atomic_fetch_add_explicit(&g_shared->retired[stat], n,
+                                memory_order_relaxed);
+      return;
+    }
+  }
+  uint64_t value = atomic_load_explicit(&slot->counters[stat],
+                                        memory_order_relaxed);
+  atomic_store_explicit(&slot->counters[stat], value + n,
+                        memory_order_relaxed);
+}
+
+
+/**
+ * Sum every counter over the retired totals and the slots in use.
+ * @param totals Receives the sums.
+ */
+static void sum_counters(uint64_t totals[JSHELL_STAT_COUNT]) {
+  for (int i = 0; i < JSHELL_STAT_COUNT; i++) {
+    totals[i] = atomic_load_explicit(&g_shared->retired[i],
+                                     memory_order_relaxed);
+  }
+  for (int s = 0; s < STATS_SLOTS; s++) {
+    JShellStatsSlot* slot = &g_shared->slots[s];
+    if (atomic_load_explicit(&slot->state, memory_order_acquire)
+        == SLOT_FREE) {
+      continue;
+    }
+    for (int i = 0; i < JSHELL_STAT_COUNT; i++) {
+      totals[i] += atomic_load_explicit(&slot->counters[i],
+                                        memory_order_relaxed);
+    }
+  }
+}
+
+
+void jshell_stats_read(uint64_t totals[JSHELL_STAT_COUNT]) {
+  if (g_shared == NULL) {
+    for (int i = 0; i < JSHELL_STAT_COUNT; i++) {
+      totals[i] = 0;
+    }
+    return;
+  }
+  sum_counters(totals);
+  for (int i = 0; i < JSHELL_STAT_COUNT; i++) {
+    uint64_t base = atomic_load_explicit(&g_shared->baseline[i],
+                                         memory_order_relaxed);
+    totals[i] = totals[i] > base ? totals[i] - base : 0;
+  }
+}
+
+
+void jshell_stats_reset(void) {
+  if (g_shared == NULL) {
+    return;
+  }
+  uint64_t totals[JSHELL_STAT_COUNT];
+  sum_counters(totals);
+  for (int i = 0; i < JSHELL_STAT_COUNT; i++) {
+    atomic_store_explicit(&g_shared->baseline[i], totals[i],
+                          memory_order_relaxed);
+  }
+}
+
+
+const char* jshell_stats_name(JShellStat stat) {
+  return stat >= 0 && stat < JSHELL_STAT_COUNT ? stat_names[stat] : "?";
+}
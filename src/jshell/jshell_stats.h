@@ -0,0 +1,56 @@
+#ifndef JSHELL_STATS_H
+#define JSHELL_STATS_H
+
+#include <stdint.h>
+
+
+// Always-on counters of what the shell does (commands run by kind,
+// processes started, cache hit rates, captured bytes, AI requests,
+// package reloads), for catching regressions in long-running shells
+//
+// Each thread counts into a slot of its own, so an update is a plain
+// add without locks or shared cache lines; reads add up all slots. The
+// slots live in memory shared with forked children, so a `--serve`
+// client sees the totals of the server and all its connections.
+typedef enum {
+  JSHELL_STAT_CMD_BUILTIN,      // Builtins and apps run on the calling thread
+  JSHELL_STAT_CMD_THREAD,       // Builtins and apps run on a worker thread
+  JSHELL_STAT_CMD_EXTERNAL,     // External programs started
+  JSHELL_STAT_CMD_PACKAGE,      // Package commands started
+  JSHELL_STAT_SPAWNS,           // Children started with posix_spawn()
+  JSHELL_STAT_FORKS,            // Children started with fork()
+  JSHELL_STAT_PATH_HITS,        // Command lookups answered by the PATH cache
+  JSHELL_STAT_PATH_MISSES,      // Command lookups that searched PATH
+  JSHELL_STAT_PARSE_HITS,       // Lines whose plan was cached
+  JSHELL_STAT_PARSE_MISSES,     // Lines parsed and lowered
+  JSHELL_STAT_RESULT_HITS,      // Commands answered by the result cache
+  JSHELL_STAT_RESULT_MISSES,    // Cacheable commands run and recorded
+  JSHELL_STAT_CAPTURES,         // Command substitutions
+  JSHELL_STAT_CAPTURE_BYTES,    // Bytes they captured
+  JSHELL_STAT_AI_REQUESTS,      // Requests to the AI backend
+  JSHELL_STAT_AI_ERRORS,        // Of which failed
+  JSHELL_STAT_AI_LATENCY_US,    // Their total duration
+  JSHELL_STAT_PKG_RELOADS,      // Package table reloads
+  JSHELL_STAT_COUNT
+} JShellStat;
+
+
+// Map the shared counters; call once at startup, before forking
+// Until then, and if the mapping fails, updates are dropped
+void jshell_stats_init(void);
+
+// Add n to a counter of the calling thread
+void jshell_stats_add(JShellStat stat, uint64_t n);
+
+// Fill totals with every counter summed over all threads and processes,
+// less the values at the last reset
+void jshell_stats_read(uint64_t totals[JSHELL_STAT_COUNT]);
+
+// Start counting from zero again, for every process sharing the counters
+void jshell_stats_reset(void);
+
+// Name of a counter as reported by the stats builtin
+const char* jshell_stats_name(JShellStat stat);
+
+
+#endif
@@ -1,15 +1,36 @@
 /**
  * @file jshell_thread_exec.c
  * @brief Threaded execution of builtin commands with I/O redirection.
+ *
+ * Builtins receive their redirected stdin/stdout as per-thread JShellIO
+ * streams, and apps linked into jbox the same streams through a
+ * jbox_ctx_t, so several such threads can run concurrently, e.g. as the
+ * stages of one pipeline. Each run also holds the working directory it
+ * was started in, so a cd meanwhile does not move it.
  */
 
 #define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 
 #include "jshell_thread_exec.h"
+#include "jshell_cwd.h"
+#include "jshell_io.h"
+#include "jshell_job_control.h"
+#include "jshell_register_externals.h"
+#include "jshell_signals.h"
+#include "jshell_stats.h"
+#include "jshell_trace.h"
+#include "jshell_vars.h"
+#include "utils/jbox_ctx.h"
 #include "utils/jbox_utils.h"
 
 
@@ -24,14 +45,71 @@ static const char* MAIN_THREAD_BUILTINS[] = {
   "unset",
   "wait",
   "type",     // Fast lookup, avoids ASan thread inspection race
+  "hash",     // Reads and resets the shell's path cache
   "help",     // Fast lookup
   "pwd",      // Fast syscall
   "env",      // Fast read
   "history",  // Fast read
+  "date",     // Fast clock read
   NULL
 };
 
 
+/**
+ * Builtins whose purpose is to change shell state. Inside a pipeline they
+ * run in a forked child, like a subshell, so the change does not leak into
+ * the interactive shell.
+ */
+static const char* STATE_MODIFYING_BUILTINS[] = {
+  "cd",
+  "export",
+  "unset",
+  "wait",
+  "hash",
+  NULL
+};
+
+
+/**
+ * Builtins that read the job table, which only the main thread may touch
+ * while jobs run. Started with `&` they still run to completion before the
+ * prompt returns.
+ */
+static const char* JOB_TABLE_BUILTINS[] = {
+  "jobs",
+  "kill",
+  "ps",
+  NULL
+};
+
+
+/** Workers kept for reuse; beyond this, busy periods use one-off threads */
+#define BUILTIN_POOL_SIZE 16
+
+/** Initial size of a worker's argument arena */
+#define BUILTIN_ARENA_SIZE 4096
+
+/** Pool workers, started on demand and kept for the life of the shell */
+static JShellBuiltinThread g_pool[BUILTIN_POOL_SIZE];
+static atomic_uint g_pool_started = 0;
+
+/** Idle stack: change counter in the high half, top index + 1 below */
+static _Atomic uint64_t g_idle_head = 0;
+
+
+/** A builtin running detached from the shell as a background job */
+typedef struct {
+  const jshell_cmd_spec_t* spec;
+  int argc;
+  char** argv;
+  int input_fd;
+  int output_fd;
+  int job_id;
+  const atomic_bool* cancelled;
+  JShellCwd* cwd;     // Directory the job was started in
+} JShellBuiltinJob;
+
+
 /**
  * Create a deep copy of an argv array.
  * @param argc Number of arguments.
@@ -88,89 +166,387 @@ static void free_argv(int argc, char** argv) {
 
 
 /**
- * Thread entry point for executing a builtin command.
- * Handles I/O redirection, runs the command, and signals completion.
- * @param arg Pointer to JShellBuiltinThread structure.
- * @return NULL (pthread return value).
+ * Run a command with stdin/stdout redirected via process-wide dup2().
+ * Only used for pkg, which is linked into jshell but writes to stdout
+ * directly and knows nothing of JShellIO or jbox_ctx_t. Callers must
+ * make sure no other such command runs concurrently. The default
+ * buffering is put back once it returns, in case it changed it.
+ * @param spec Command specification.
+ * @param argc Number of arguments.
+ * @param argv Array of argument strings.
+ * @param input_fd Descriptor for stdin (-1 for none), closed on return.
+ * @param output_fd Descriptor for stdout (-1 for none), closed on return.
+ * @return Exit code of the command, or 1 if redirection failed.
  */
-static void* builtin_thread_entry(void* arg) {
-  JShellBuiltinThread* bt = (JShellBuiltinThread*)arg;
-
-  DPRINT("Thread entry for builtin: %s", bt->spec->name);
-
+static int run_with_fd_redirection(const jshell_cmd_spec_t* spec,
+                                   int argc, char** argv,
+                                   int input_fd, int output_fd) {
   int saved_stdin = -1;
   int saved_stdout = -1;
+  int exit_code = 1;
 
-  if (bt->input_fd != -1) {
+  /* Whatever the shell left buffered belongs on its own stdout */
+  fflush(stdout);
+
+  if (input_fd != -1) {
     saved_stdin = dup(STDIN_FILENO);
     if (saved_stdin == -1) {
-      perror("dup stdin in thread");
-      bt->exit_code = 1;
-      goto cleanup;
+      perror("dup stdin");
+      goto out;
     }
-    if (dup2(bt->input_fd, STDIN_FILENO) == -1) {
-      perror("dup2 input in thread");
-      close(saved_stdin);
-      bt->exit_code = 1;
-      goto cleanup;
+    if (dup2(input_fd, STDIN_FILENO) == -1) {
+      perror("dup2 input");
+      goto out;
     }
-    close(bt->input_fd);
-    bt->input_fd = -1;
   }
 
-  if (bt->output_fd != -1) {
+  if (output_fd != -1) {
     saved_stdout = dup(STDOUT_FILENO);
     if (saved_stdout == -1) {
-      perror("dup stdout in thread");
-      if (saved_stdin != -1) {
-        dup2(saved_stdin, STDIN_FILENO);
-        close(saved_stdin);
-      }
-      bt->exit_code = 1;
-      goto cleanup;
+      perror("dup stdout");
+      goto out;
     }
-    if (dup2(bt->output_fd, STDOUT_FILENO) == -1) {
-      perror("dup2 output in thread");
-      close(saved_stdout);
-      if (saved_stdin != -1) {
-        dup2(saved_stdin, STDIN_FILENO);
-        close(saved_stdin);
-      }
-      bt->exit_code = 1;
-      goto cleanup;
+    if (dup2(output_fd, STDOUT_FILENO) == -1) {
+      perror("dup2 output");
+      goto out;
     }
-    close(bt->output_fd);
-    bt->output_fd = -1;
   }
 
-  bt->exit_code = bt->spec->run(bt->argc, bt->argv);
+  exit_code = spec->run(argc, argv);
 
   // Flush stdout to ensure all output goes to the redirected fd
   fflush(stdout);
 
-  DPRINT("Thread builtin %s completed with exit code %d",
-         bt->spec->name, bt->exit_code);
-
+out:
   if (saved_stdout != -1) {
     dup2(saved_stdout, STDOUT_FILENO);
     close(saved_stdout);
   }
-
+  setvbuf(stdout, NULL, isatty(STDOUT_FILENO) ? _IOLBF : _IOFBF, BUFSIZ);
   if (saved_stdin != -1) {
     dup2(saved_stdin, STDIN_FILENO);
     close(saved_stdin);
   }
+  if (input_fd != -1) {
+    close(input_fd);
+  }
+  if (output_fd != -1) {
+    close(output_fd);
+  }
+
+  return exit_code;
+}
+
+
+/**
+ * Run a linked app under its own jbox_ctx_t, reading and writing the
+ * invocation's streams and stopping on the shell's interrupt flag or the
+ * thread's cancel flag.
+ * @param spec Command specification.
+ * @param argc Number of arguments.
+ * @param argv Array of argument strings.
+ * @param io Streams of the invocation.
+ * @return Exit code of the app.
+ */
+static int run_linked_app(const jshell_cmd_spec_t* spec, int argc,
+                          char** argv, const JShellIO* io) {
+  jbox_ctx_t ctx;
+  jbox_ctx_init(&ctx);
+  ctx.in = io->in;
+  ctx.out = io->out;
+  ctx.interrupted = &jshell_interrupted;
+  ctx.records_out = io->records_out;
+  ctx.cwd_fd = jshell_cwd_fd();
+  /* A pipeline stage stops when cancelled, a background job when killed */
+  ctx.cancelled = jshell_get_thread_stage_flag();
+  if (ctx.cancelled == NULL) {
+    ctx.cancelled = jshell_get_thread_cancel_flag();
+  }
+  return jbox_ctx_run(&ctx, spec->run, argc, argv);
+}
+
+
+/**
+ * Run a command on the calling thread with its stdin and stdout taken
+ * from descriptors or ring pipe ends, or stdout from a caller's stream.
+ * @param spec Command specification.
+ * @param argc Number of arguments.
+ * @param argv Array of argument strings.
+ * @param input_fd Descriptor for stdin (-1 for none), owned by the call.
+ * @param input_ring Ring for stdin (NULL for none), owned by the call.
+ * @param output_fd Descriptor for stdout (-1 for none), owned by the call.
+ * @param output_ring Ring for stdout (NULL for none), owned by the call.
+ * @param output_stream Stream for stdout (NULL for none), flushed but
+ *                      left open.
+ * @param records_out Whether stdout goes to a stage reading records.
+ * @return Exit code of the command, or 1 if redirection failed.
+ */
+static int run_builtin_ends(const jshell_cmd_spec_t* spec, int argc,
+                            char** argv, int input_fd,
+                            JShellRing* input_ring, int output_fd,
+                            JShellRing* output_ring, FILE* output_stream,
+                            bool records_out) {
+  bool linked = jshell_is_linked_command(spec);
+  jshell_vars_sync_environ();   /* In-process commands read getenv() too */
+  if (spec->type != CMD_BUILTIN && !linked) {
+    return run_with_fd_redirection(spec, argc, argv, input_fd, output_fd);
+  }
+
+  uint64_t trace_start = jshell_trace_begin();
+  JShellIO io;
+  if (jshell_io_open_ends(&io, input_fd, input_ring,
+                          output_fd, output_ring) != 0) {
+    return 1;
+  }
+  if (output_stream != NULL) {
+    io.out = output_stream;
+  }
+  io.records_out = records_out;
+
+  int exit_code;
+  if (linked) {
+    exit_code = run_linked_app(spec, argc, argv, &io);
+  } else {
+    const JShellIO* previous = jshell_io_set_current(&io);
+    exit_code = spec->run(argc, argv);
+    jshell_io_set_current(previous);
+  }
+
+  jshell_io_close(&io);
+  jshell_trace_end("builtin", spec->name, trace_start);
+  return exit_code;
+}
+
+
+/**
+ * Run a command with the given redirections on the calling thread.
+ * Builtins get private streams installed through JShellIO, and linked
+ * apps the same streams through a jbox_ctx_t, so the process-wide
+ * descriptors are untouched and other builtins and apps may run on
+ * other threads at the same time.
+ * @param spec Command specification.
+ * @param argc Number of arguments.
+ * @param argv Array of argument strings.
+ * @param input_fd Descriptor for stdin (-1 for none), owned by the call.
+ * @param output_fd Descriptor for stdout (-1 for none), owned by the call.
+ * @return Exit code of the command, or 1 if redirection failed.
+ */
+int jshell_run_builtin(const jshell_cmd_spec_t* spec, int argc, char** argv,
+                       int input_fd, int output_fd) {
+  jshell_stats_add(JSHELL_STAT_CMD_BUILTIN, 1);
+  return run_builtin_ends(spec, argc, argv, input_fd, NULL, output_fd, NULL,
+                          NULL, false);
+}
+
+
+/**
+ * Copy argv into a worker's arena, growing the arena when it is too small.
+ * The arena is kept between runs, so steady dispatch does not allocate.
+ * @param bt Worker.
+ * @param argc Number of arguments.
+ * @param argv Array of argument strings.
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int copy_argv_to_arena(JShellBuiltinThread* bt, int argc,
+                              char** argv) {
+  size_t needed = (size_t)(argc + 1) * sizeof(char*);
+  for (int i = 0; i < argc; i++) {
+    needed += argv[i] != NULL ? strlen(argv[i]) + 1 : 0;
+  }
+
+  if (needed > bt->arena_size) {
+    size_t size = bt->arena_size ? bt->arena_size : BUILTIN_ARENA_SIZE;
+    while (size < needed) {
+      size *= 2;
+    }
+    char* grown = realloc(bt->arena, size);
+    if (grown == NULL) {
+      return -1;
+    }
+    bt->arena = grown;
+    bt->arena_size = size;
+  }
 
-cleanup:
-  pthread_mutex_lock(&bt->mutex);
-  bt->completed = true;
-  pthread_cond_signal(&bt->cond);
-  pthread_mutex_unlock(&bt->mutex);
+  char** copy = (char**)bt->arena;
+  char* strings = bt->arena + (size_t)(argc + 1) * sizeof(char*);
+  for (int i = 0; i < argc; i++) {
+    if (argv[i] == NULL) {
+      copy[i] = NULL;
+      continue;
+    }
+    size_t len = strlen(argv[i]) + 1;
+    memcpy(strings, argv[i], len);
+    copy[i] = strings;
+    strings += len;
+  }
+  copy[argc] = NULL;
+
+  bt->argc = argc;
+  bt->argv = copy;
+  return 0;
+}
 
+
+/**
+ * Run the builtin handed to a worker and signal its completion.
+ * @param bt Worker with spec, argv and descriptors filled in.
+ */
+static void run_builtin_task(JShellBuiltinThread* bt) {
+  DPRINT("Worker running builtin: %s", bt->spec->name);
+
+  int input_fd = bt->input_fd;
+  int output_fd = bt->output_fd;
+  JShellRing* input_ring = bt->input_ring;
+  JShellRing* output_ring = bt->output_ring;
+  FILE* output_stream = bt->output_stream;
+  bt->input_fd = -1;
+  bt->output_fd = -1;
+  bt->input_ring = NULL;
+  bt->output_ring = NULL;
+  bt->output_stream = NULL;
+  jshell_set_thread_cancel_flag(bt->cancelled);
+  jshell_set_thread_stage_flag(bt->stage_cancelled);
+  JShellCwd* previous_cwd = jshell_cwd_set_thread(bt->cwd);
+  if (input_ring != NULL && bt->stage_cancelled != NULL) {
+    /* Waiting for data that would have no reader is pointless too */
+    jshell_ring_cancel_reads_on(input_ring, bt->stage_cancelled);
+  }
+
+  /* Workers are reused, so the run's CPU time is a difference */
+  JShellUsage before = {0};
+  jshell_usage_of_thread(&before);
+  uint64_t start = jshell_usage_now();
+  jshell_stats_add(JSHELL_STAT_CMD_THREAD, 1);
+  bt->exit_code = run_builtin_ends(bt->spec, bt->argc, bt->argv,
+                                   input_fd, input_ring,
+                                   output_fd, output_ring, output_stream,
+                                   bt->records_out);
+  jshell_usage_of_thread(&bt->usage);
+  bt->usage.user_us -= before.user_us;
+  bt->usage.sys_us -= before.sys_us;
+  bt->usage.wall_us = jshell_usage_now() - start;
+  jshell_set_thread_cancel_flag(NULL);
+  jshell_set_thread_stage_flag(NULL);
+  jshell_cwd_set_thread(previous_cwd);
+  jshell_cwd_unref(bt->cwd);
+  bt->cwd = NULL;
+
+  DPRINT("Worker builtin %s completed with exit code %d",
+         bt->spec->name, bt->exit_code);
+
+  /* The last access to bt: the waiter may hand it out again right after */
+  uint64_t one = 1;
+  while (write(bt->done_fd, &one, sizeof(one)) == -1 && errno == EINTR) {
+  }
+}
+
+
+/**
+ * Thread entry point of a pool worker: runs one builtin per start signal,
+ * for the life of the shell.
+ * @param arg Pointer to the worker's JShellBuiltinThread.
+ * @return Never returns.
+ */
+static void* pool_worker_main(void* arg) {
+  JShellBuiltinThread* bt = (JShellBuiltinThread*)arg;
+
+  while (true) {
+    while (sem_wait(&bt->start) != 0) {
+      /* EINTR: keep waiting */
+    }
+    run_builtin_task(bt);
+  }
   return NULL;
 }
 
 
+/**
+ * Thread entry point of a one-off worker, used when the pool is busy.
+ * @param arg Pointer to JShellBuiltinThread structure.
+ * @return NULL (pthread return value).
+ */
+static void* oneoff_worker_main(void* arg) {
+  run_builtin_task((JShellBuiltinThread*)arg);
+  return NULL;
+}
+
+
+/**
+ * Push a pool worker onto the idle stack.
+ * @param index Position of the worker in the pool.
+ */
+static void idle_push(uint32_t index) {
+  uint64_t head = atomic_load(&g_idle_head);
+  uint64_t next;
+  do {
+    atomic_store(&g_pool[index].next_idle, (uint32_t)head);
+    next = ((head >> 32) + 1) << 32 | (index + 1);
+  } while (!atomic_compare_exchange_weak(&g_idle_head, &head, next));
+}
+
+
+/**
+ * Pop an idle pool worker.
+ * The head carries a change counter next to the index, so a worker
+ * popped and pushed back meanwhile makes the exchange fail (no ABA).
+ * @return The worker, or NULL if none is idle.
+ */
+static JShellBuiltinThread* idle_pop(void) {
+  uint64_t head = atomic_load(&g_idle_head);
+  uint64_t next;
+  do {
+    uint32_t top = (uint32_t)head;
+    if (top == 0) {
+      return NULL;
+    }
+    uint32_t below = atomic_load(&g_pool[top - 1].next_idle);
+    next = ((head >> 32) + 1) << 32 | below;
+  } while (!atomic_compare_exchange_weak(&g_idle_head, &head, next));
+
+  return &g_pool[(uint32_t)head - 1];
+}
+
+
+/**
+ * Start a new pool worker if the pool is not full.
+ * @return The worker, reserved for the caller, or NULL.
+ */
+static JShellBuiltinThread* pool_grow(void) {
+  uint32_t index = atomic_fetch_add(&g_pool_started, 1);
+  if (index >= BUILTIN_POOL_SIZE) {
+    atomic_fetch_sub(&g_pool_started, 1);
+    return NULL;
+  }
+
+  JShellBuiltinThread* bt = &g_pool[index];
+  bt->pooled = true;
+  bt->done_fd = eventfd(0, EFD_CLOEXEC);
+  if (bt->done_fd == -1 || sem_init(&bt->start, 0, 0) != 0) {
+    perror("jshell: builtin worker");
+    if (bt->done_fd != -1) {
+      close(bt->done_fd);
+    }
+    bt->done_fd = -1;
+    bt->pooled = false;
+    return NULL;     /* The slot stays used; the pool is one smaller */
+  }
+
+  int rc = pthread_create(&bt->thread, NULL, pool_worker_main, bt);
+  if (rc != 0) {
+    fprintf(stderr, "jshell: builtin worker: %s\n", strerror(rc));
+    sem_destroy(&bt->start);
+    close(bt->done_fd);
+    bt->done_fd = -1;
+    bt->pooled = false;
+    return NULL;
+  }
+  pthread_detach(bt->thread);
+
+  DPRINT("Started builtin pool worker %u", index);
+  return bt;
+}
+
+
 /**
  * Check if a builtin command must run on the main thread.
  * @param cmd_name Name of the builtin command.
@@ -192,7 +568,27 @@ bool jshell_builtin_requires_main_thread(const char* cmd_name) {
 
 
 /**
- * Spawn a new thread to execute a builtin command.
+ * Check if a builtin can run as an in-process pipeline stage.
+ * @param cmd_name Name of the builtin command.
+ * @return true unless the builtin exists to modify shell state.
+ */
+bool jshell_builtin_is_pipeline_safe(const char* cmd_name) {
+  if (cmd_name == NULL) {
+    return false;
+  }
+
+  for (int i = 0; STATE_MODIFYING_BUILTINS[i] != NULL; i++) {
+    if (strcmp(cmd_name, STATE_MODIFYING_BUILTINS[i]) == 0) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+/**
+ * Run a builtin on a worker thread.
  * @param spec Command specification for the builtin.
  * @param argc Number of arguments.
  * @param argv Array of argument strings.
@@ -206,62 +602,105 @@ JShellBuiltinThread* jshell_spawn_builtin_thread(
     char** argv,
     int input_fd,
     int output_fd) {
+  JShellStageIO io = {
+    .input_fd = input_fd,
+    .output_fd = output_fd,
+  };
+  return jshell_spawn_builtin_stage(spec, argc, argv, &io);
+}
 
-  if (spec == NULL || argc <= 0 || argv == NULL) {
-    return NULL;
-  }
 
-  JShellBuiltinThread* bt = calloc(1, sizeof(JShellBuiltinThread));
-  if (bt == NULL) {
-    perror("calloc JShellBuiltinThread");
-    return NULL;
-  }
+/**
+ * Run a builtin pipeline stage on a worker thread.
+ * Takes an idle pool worker, starts another one while the pool is not
+ * full, and only when every pool worker is busy (e.g. a long pipeline of
+ * builtins) creates a one-off thread, so every stage still gets a thread.
+ * @param spec Command specification for the builtin.
+ * @param argc Number of arguments.
+ * @param argv Array of argument strings.
+ * @param io Where the stage reads and writes, and its cancel flag.
+ * @return Pointer to JShellBuiltinThread on success, NULL on failure.
+ */
+JShellBuiltinThread* jshell_spawn_builtin_stage(
+    const jshell_cmd_spec_t* spec,
+    int argc,
+    char** argv,
+    const JShellStageIO* io) {
 
-  bt->spec = spec;
-  bt->argc = argc;
-  bt->argv = copy_argv(argc, argv);
-  if (bt->argv == NULL) {
-    free(bt);
+  if (spec == NULL || argc <= 0 || argv == NULL) {
     return NULL;
   }
 
-  bt->input_fd = input_fd;
-  bt->output_fd = output_fd;
-  bt->exit_code = 0;
-  bt->completed = false;
+  uint64_t trace_start = jshell_trace_begin();
 
-  if (pthread_mutex_init(&bt->mutex, NULL) != 0) {
-    perror("pthread_mutex_init");
-    free_argv(bt->argc, bt->argv);
-    free(bt);
-    return NULL;
+  JShellBuiltinThread* bt = idle_pop();
+  if (bt == NULL) {
+    bt = pool_grow();
   }
-
-  if (pthread_cond_init(&bt->cond, NULL) != 0) {
-    perror("pthread_cond_init");
-    pthread_mutex_destroy(&bt->mutex);
-    free_argv(bt->argc, bt->argv);
-    free(bt);
-    return NULL;
+  if (bt == NULL) {
+    bt = calloc(1, sizeof(JShellBuiltinThread));
+    if (bt == NULL) {
+      perror("calloc JShellBuiltinThread");
+      return NULL;
+    }
+    bt->done_fd = eventfd(0, EFD_CLOEXEC);
+    if (bt->done_fd == -1) {
+      perror("eventfd");
+      free(bt);
+      return NULL;
+    }
   }
 
-  if (pthread_create(&bt->thread, NULL, builtin_thread_entry, bt) != 0) {
-    perror("pthread_create");
-    pthread_cond_destroy(&bt->cond);
-    pthread_mutex_destroy(&bt->mutex);
-    free_argv(bt->argc, bt->argv);
-    free(bt);
+  /* Nothing of the caller's is handed over until the worker can run */
+  bt->input_fd = -1;
+  bt->output_fd = -1;
+  if (copy_argv_to_arena(bt, argc, argv) != 0) {
+    jshell_free_builtin_thread(bt);
     return NULL;
   }
+  bt->spec = spec;
+  bt->input_fd = io->input_fd;
+  bt->output_fd = io->output_fd;
+  bt->input_ring = io->input_ring;
+  bt->output_ring = io->output_ring;
+  bt->output_stream = io->output_stream;
+  bt->records_out = io->records_out;
+  bt->stage_cancelled = io->cancel;
+  bt->exit_code = 0;
+  bt->usage = (JShellUsage){0};
+  bt->cancelled = jshell_get_thread_cancel_flag();
+  bt->cwd = jshell_cwd_ref(jshell_cwd_current());
+
+  if (bt->pooled) {
+    sem_post(&bt->start);
+  } else {
+    int rc = pthread_create(&bt->thread, NULL, oneoff_worker_main, bt);
+    if (rc != 0) {
+      fprintf(stderr, "pthread_create: %s\n", strerror(rc));
+      /* The caller keeps ownership of the descriptors and rings */
+      bt->input_fd = -1;
+      bt->output_fd = -1;
+      bt->input_ring = NULL;
+      bt->output_ring = NULL;
+      jshell_cwd_unref(bt->cwd);
+      close(bt->done_fd);
+      free(bt->arena);
+      free(bt);
+      return NULL;
+    }
+    bt->joinable = true;
+  }
+  jshell_trace_end("thread_spawn", spec->name, trace_start);
 
-  DPRINT("Spawned thread for builtin: %s", spec->name);
+  DPRINT("Dispatched builtin %s to a %s worker", spec->name,
+         bt->pooled ? "pool" : "one-off");
   return bt;
 }
 
 
 /**
  * Wait for a builtin thread to complete execution.
- * Blocks until the thread finishes.
+ * Blocks on the worker's eventfd until the run has finished.
  * @param bt Pointer to JShellBuiltinThread to wait for.
  * @return Exit code from the builtin command, or -1 if bt is NULL.
  */
@@ -272,37 +711,193 @@ int jshell_wait_builtin_thread(JShellBuiltinThread* bt) {
 
   DPRINT("Waiting for builtin thread: %s", bt->spec->name);
 
-  pthread_join(bt->thread, NULL);
+  uint64_t trace_start = jshell_trace_begin();
+  uint64_t count;
+  while (read(bt->done_fd, &count, sizeof(count)) == -1 && errno == EINTR) {
+  }
+  if (bt->joinable) {
+    pthread_join(bt->thread, NULL);
+    bt->joinable = false;
+  }
+  jshell_trace_end("thread_wait", bt->spec->name, trace_start);
 
   return bt->exit_code;
 }
 
 
 /**
- * Free resources associated with a builtin thread.
- * Thread must have been joined before calling this function.
- * @param bt Pointer to JShellBuiltinThread to free.
+ * Get the descriptor that becomes readable when a builtin thread's run
+ * has finished, to wait for it alongside other events.
+ * @param bt Builtin thread.
+ * @return eventfd of the worker.
+ */
+int jshell_builtin_thread_fd(const JShellBuiltinThread* bt) {
+  return bt->done_fd;
+}
+
+
+/**
+ * Release a builtin thread after jshell_wait_builtin_thread(): a pool
+ * worker goes back to the idle stack, a one-off worker is freed.
+ * @param bt Pointer to JShellBuiltinThread to release.
  */
 void jshell_free_builtin_thread(JShellBuiltinThread* bt) {
   if (bt == NULL) {
     return;
   }
 
-  DPRINT("Freeing builtin thread resources: %s", bt->spec->name);
-
-  pthread_cond_destroy(&bt->cond);
-  pthread_mutex_destroy(&bt->mutex);
-
-  if (bt->argv != NULL) {
-    free_argv(bt->argc, bt->argv);
-  }
-
   if (bt->input_fd != -1) {
     close(bt->input_fd);
+    bt->input_fd = -1;
   }
   if (bt->output_fd != -1) {
     close(bt->output_fd);
+    bt->output_fd = -1;
+  }
+  if (bt->input_ring != NULL) {
+    jshell_ring_close_reader(bt->input_ring);
+    bt->input_ring = NULL;
+  }
+  if (bt->output_ring != NULL) {
+    jshell_ring_close_writer(bt->output_ring);
+    bt->output_ring = NULL;
+  }
+  bt->argv = NULL;
+  bt->argc = 0;
+
+  if (bt->pooled) {
+    idle_push((uint32_t)(bt - g_pool));
+    return;
   }
 
+  if (bt->joinable) {
+    pthread_join(bt->thread, NULL);
+  }
+  close(bt->done_fd);
+  free(bt->arena);
   free(bt);
 }
+
+
+/**
+ * Thread entry point for a builtin running as a background job.
+ * Runs the command, hands its exit status to the job table and frees
+ * the job's arguments.
+ * @param arg Pointer to JShellBuiltinJob structure.
+ * @return NULL (pthread return value).
+ */
+static void* builtin_job_entry(void* arg) {
+  JShellBuiltinJob* bj = (JShellBuiltinJob*)arg;
+
+  jshell_set_thread_cancel_flag(bj->cancelled);
+  jshell_cwd_set_thread(bj->cwd);
+  int exit_code = jshell_run_builtin(bj->spec, bj->argc, bj->argv,
+                                     bj->input_fd, bj->output_fd);
+  jshell_cwd_set_thread(NULL);
+  DPRINT("Background builtin %s (job %d) completed with exit code %d",
+         bj->spec->name, bj->job_id, exit_code);
+
+  jshell_finish_thread_job(bj->job_id, exit_code, NULL);
+  jshell_cwd_unref(bj->cwd);
+  free_argv(bj->argc, bj->argv);
+  free(bj);
+  return NULL;
+}
+
+
+/**
+ * Check if a builtin can run detached as a background job.
+ * @param cmd_name Name of the builtin command.
+ * @return false for builtins that need the main thread or the job table.
+ */
+bool jshell_builtin_can_run_detached(const char* cmd_name) {
+  if (cmd_name == NULL || jshell_builtin_requires_main_thread(cmd_name)) {
+    return false;
+  }
+
+  for (int i = 0; JOB_TABLE_BUILTINS[i] != NULL; i++) {
+    if (strcmp(cmd_name, JOB_TABLE_BUILTINS[i]) == 0) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+/**
+ * Start a builtin on a detached thread, tracked as a background job.
+ * Without an input redirection the job reads /dev/null, so it never
+ * competes with the prompt for the terminal.
+ * @param spec Command specification for the builtin.
+ * @param argc Number of arguments.
+ * @param argv Array of argument strings.
+ * @param input_fd File descriptor for stdin redirection (-1 for none).
+ * @param output_fd File descriptor for stdout redirection (-1 for none).
+ * @param cmd_string Command line shown by `jobs`.
+ * @return Job ID, or -1 on failure (the descriptors are left open).
+ */
+int jshell_start_builtin_job(const jshell_cmd_spec_t* spec, int argc,
+                             char** argv, int input_fd, int output_fd,
+                             const char* cmd_string) {
+  JShellBuiltinJob* bj = calloc(1, sizeof(JShellBuiltinJob));
+  if (bj == NULL) {
+    return -1;
+  }
+  bj->argv = copy_argv(argc, argv);
+  if (bj->argv == NULL) {
+    free(bj);
+    return -1;
+  }
+  bj->spec = spec;
+  bj->argc = argc;
+
+  int null_fd = -1;
+  if (input_fd == -1) {
+    null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  }
+
+  int job_id = jshell_add_thread_job(cmd_string);
+  BackgroundJob* job = job_id > 0 ? jshell_find_job_by_id(job_id) : NULL;
+  if (job == NULL) {
+    if (null_fd != -1) {
+      close(null_fd);
+    }
+    free_argv(bj->argc, bj->argv);
+    free(bj);
+    return -1;
+  }
+
+  bj->input_fd = input_fd != -1 ? input_fd : null_fd;
+  bj->output_fd = output_fd;
+  bj->job_id = job_id;
+  bj->cancelled = &job->cancelled;
+  bj->cwd = jshell_cwd_ref(jshell_cwd_current());
+
+  pthread_attr_t attr;
+  pthread_t thread;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  int rc = pthread_create(&thread, &attr, builtin_job_entry, bj);
+  pthread_attr_destroy(&attr);
+
+  if (rc != 0) {
+    fprintf(stderr, "jshell: %s: cannot start thread: %s\n", spec->name,
+            strerror(rc));
+    if (bj->input_fd != -1) {
+      close(bj->input_fd);
+    }
+    if (output_fd != -1) {
+      close(output_fd);
+    }
+    jshell_cwd_unref(bj->cwd);
+    free_argv(bj->argc, bj->argv);
+    free(bj);
+    /* The job is listed already; it ends at once as failed */
+    jshell_finish_thread_job(job_id, 1, NULL);
+    return job_id;
+  }
+
+  DPRINT("Started builtin %s as background job %d", spec->name, job_id);
+  return job_id;
+}
@@ -2,26 +2,71 @@
 #define JSHELL_THREAD_EXEC_H
 
 #include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 
 #include "jshell_cmd_registry.h"
+#include "jshell_cwd.h"
+#include "jshell_ring.h"
+#include "jshell_usage.h"
 
 
-// Thread state for a builtin command execution
+// A worker thread running a builtin command
+// Pool workers are reused: jshell_free_builtin_thread() returns them to
+// the pool, and their argv lives in an arena kept between runs
 typedef struct JShellBuiltinThread {
   pthread_t thread;
   const jshell_cmd_spec_t* spec;
   int argc;
-  char** argv;
+  char** argv;        // Copy in arena
   int input_fd;
   int output_fd;
+  JShellRing* input_ring;   // Ring pipe ends, or NULL
+  JShellRing* output_ring;
   int exit_code;
-  bool completed;
-  pthread_mutex_t mutex;
-  pthread_cond_t cond;
+  JShellUsage usage;  // Of the run (not of workers it started)
+  const atomic_bool* cancelled;  // Background job the spawner belongs to
+  const atomic_bool* stage_cancelled;  // Pipeline stage's flag, or NULL
+  JShellCwd* cwd;     // Directory of the spawner, held for the run
+  FILE* output_stream;  // Written instead of output_fd, or NULL
+  bool records_out;     // The next stage reads jbox_record.h records
+  int done_fd;        // eventfd signalled when a run completes
+  sem_t start;        // Posted to hand a pool worker its run
+  char* arena;
+  size_t arena_size;
+  bool pooled;        // Pool worker, as opposed to a one-off thread
+  bool joinable;      // One-off thread not yet joined
+  _Atomic uint32_t next_idle;  // Idle stack link (index + 1, 0 for none)
 } JShellBuiltinThread;
 
-// Spawn a builtin command in a new thread
+// Where a pipeline stage run on a thread reads and writes, and what stops
+// it early
+typedef struct {
+  int input_fd;             // -1 for none
+  JShellRing* input_ring;   // Read instead of input_fd, or NULL
+  int output_fd;            // -1 for none
+  JShellRing* output_ring;  // Written instead of output_fd, or NULL
+  FILE* output_stream;      // Written instead of output_fd (not closed),
+                            // or NULL
+  bool records_out;         // The next stage reads jbox_record.h records,
+                            // so structured output may be binary
+  const atomic_bool* cancel;  // Set once nobody reads the stage's output
+                              // or on SIGINT; must outlive the stage
+} JShellStageIO;
+
+// Run a command with redirected stdin/stdout on the calling thread
+// CMD_BUILTIN commands get per-thread JShellIO streams and linked apps a
+// jbox_ctx_t over the same streams; other commands (pkg) fall back to
+// process-wide dup2() and must not run concurrently
+// Takes ownership of input_fd/output_fd (-1 for none)
+// Returns the exit code of the command
+int jshell_run_builtin(const jshell_cmd_spec_t* spec, int argc, char** argv,
+                       int input_fd, int output_fd);
+
+// Run a builtin command on a worker thread (from the pool if one is idle)
 // Returns a thread handle, or NULL on failure
 // The caller is responsible for calling jshell_wait_builtin_thread()
 // and jshell_free_builtin_thread() after use
@@ -33,11 +78,29 @@ JShellBuiltinThread* jshell_spawn_builtin_thread(
   int output_fd
 );
 
+// Like jshell_spawn_builtin_thread(), for a pipeline stage: the stage may
+// read or write ring pipes instead of descriptors, and stops once its
+// cancel flag is set; only CMD_BUILTIN commands other than linked apps
+// may take rings, as apps use raw descriptors, and only those or linked
+// apps passing jshell_linked_writes_stream_only() an output_stream. On
+// success the thread owns the descriptors and ring ends in io.
+JShellBuiltinThread* jshell_spawn_builtin_stage(
+  const jshell_cmd_spec_t* spec,
+  int argc,
+  char** argv,
+  const JShellStageIO* io
+);
+
 // Wait for a builtin thread to complete
 // Returns the exit code of the builtin command
 int jshell_wait_builtin_thread(JShellBuiltinThread* bt);
 
-// Free resources associated with a builtin thread
+// Descriptor that becomes readable once the builtin has finished, for
+// callers that wait for it among other events; jshell_wait_builtin_thread()
+// must still be called
+int jshell_builtin_thread_fd(const JShellBuiltinThread* bt);
+
+// Release a builtin thread (pool workers go back to the pool)
 // Must be called after jshell_wait_builtin_thread()
 void jshell_free_builtin_thread(JShellBuiltinThread* bt);
 
@@ -45,5 +108,22 @@ void jshell_free_builtin_thread(JShellBuiltinThread* bt);
 // Returns true if the command modifies shell state (cd, export, unset, etc.)
 bool jshell_builtin_requires_main_thread(const char* cmd_name);
 
+// Check if a builtin may run detached as a background job (`cmd &`)
+// Returns false for main-thread builtins and those reading the job table
+bool jshell_builtin_can_run_detached(const char* cmd_name);
+
+// Start a builtin on a detached thread, registered as a thread job so
+// `jobs`, `wait` and `kill` see it; takes ownership of input_fd/output_fd
+// on success (stdin is /dev/null when input_fd is -1)
+// Returns the job ID, or -1 on failure (the descriptors stay open)
+int jshell_start_builtin_job(const jshell_cmd_spec_t* spec, int argc,
+                             char** argv, int input_fd, int output_fd,
+                             const char* cmd_string);
+
+// Check if a builtin may run on a thread as a pipeline stage
+// Returns false for builtins that modify shell state (cd, export, ...),
+// which run in a forked child inside pipelines
+bool jshell_builtin_is_pipeline_safe(const char* cmd_name);
+
 
 #endif
@@ -0,0 +1,157 @@
+/**
+ * @file jshell_trace.c
+ * @brief Phase timings of command lines in Chrome trace format.
+ *
+ * Probes claim a slot of a fixed buffer with one atomic increment and
+ * publish it by storing its sequence number last, so threads never wait
+ * on each other, every slot has a single writer, and a reader can tell
+ * finished slots from slots still being written. Events past the end
+ * of the buffer are only counted. The buffer is written out once, at
+ * exit, by the process that enabled tracing.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "jshell_trace.h"
+#include "utils/jbox_json.h"
+
+
+/** One finished phase */
+typedef struct {
+  _Atomic uint64_t seq;     /* Slot index + 1 once published, else 0 */
+  uint64_t start;           /* Monotonic nanoseconds */
+  uint64_t duration;
+  const char* name;
+  pid_t tid;
+  char detail[JSHELL_TRACE_DETAIL_MAX];
+} JShellTraceEvent;
+
+
+bool jshell_trace_enabled = false;
+
+static JShellTraceEvent* g_events = NULL;
+static _Atomic uint64_t g_next = 0;
+static char* g_path = NULL;
+static pid_t g_pid = 0;
+static uint64_t g_origin = 0;
+
+
+/**
+ * Get monotonic time in nanoseconds.
+ * @return Nanoseconds since an arbitrary fixed point.
+ */
+uint64_t jshell_trace_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+
+/**
+ * Record a finished phase in the event buffer.
+ * @param name Phase name, a string literal.
+ * @param detail What the phase worked on, or NULL.
+ * @param start Start time from jshell_trace_begin().
+ */
+void jshell_trace_record(const char* name, const char* detail,
+                         uint64_t start) {
+  uint64_t end = jshell_trace_now();
+  uint64_t index = atomic_fetch_add_explicit(&g_next, 1,
+                                             memory_order_relaxed);
+  if (index >= JSHELL_TRACE_CAPACITY) {
+    return;
+  }
+
+  JShellTraceEvent* event = &g_events[index];
+  event->start = start;
+  event->duration = end - start;
+  event->name = name;
+  event->tid = gettid();
+  if (detail != NULL) {
+    strncpy(event->detail, detail, sizeof(event->detail) - 1);
+    event->detail[sizeof(event->detail) - 1] = '\0';
+  } else {
+    event->detail[0] = '\0';
+  }
+  atomic_store_explicit(&event->seq, index + 1, memory_order_release);
+}
+
+
+/**
+ * Write the recorded phases to the JSHELL_TRACE file.
+ * Registered with atexit(); forked children that exit skip it.
+ */
+static void jshell_trace_dump(void) {
+  if (getpid() != g_pid) {
+    return;
+  }
+  jshell_trace_enabled = false;
+
+  FILE* out = fopen(g_path, "w");
+  if (out == NULL) {
+    perror(g_path);
+    return;
+  }
+
+  uint64_t next = atomic_load_explicit(&g_next, memory_order_relaxed);
+  uint64_t count = next < JSHELL_TRACE_CAPACITY
+                   ? next : JSHELL_TRACE_CAPACITY;
+  bool first_event = true;
+
+  fputs("{\"traceEvents\":[\n", out);
+  for (uint64_t i = 0; i < count; i++) {
+    JShellTraceEvent* event = &g_events[i];
+    if (atomic_load_explicit(&event->seq, memory_order_acquire) != i + 1) {
+      continue;
+    }
+    fprintf(out, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+                 "\"ts\":%.3f,\"dur\":%.3f",
+            first_event ? "" : ",\n", event->name, (int)g_pid,
+            (int)event->tid, (double)(event->start - g_origin) / 1000.0,
+            (double)event->duration / 1000.0);
+    if (event->detail[0] != '\0') {
+      fputs(",\"args\":{\"detail\":", out);
+      jbox_json_write_string(out, event->detail);
+      fputc('}', out);
+    }
+    fputc('}', out);
+    first_event = false;
+  }
+  fprintf(out, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":"
+               "{\"dropped\":%llu}}\n",
+          (unsigned long long)(next - count));
+  fclose(out);
+}
+
+
+/**
+ * Enable tracing if JSHELL_TRACE names an output file.
+ */
+void jshell_trace_init(void) {
+  const char* path = getenv("JSHELL_TRACE");
+  if (path == NULL || *path == '\0' || g_events != NULL) {
+    return;
+  }
+
+  g_events = calloc(JSHELL_TRACE_CAPACITY, sizeof(JShellTraceEvent));
+  g_path = strdup(path);
+  if (g_events == NULL || g_path == NULL) {
+    perror("jshell: trace buffer");
+    free(g_events);
+    free(g_path);
+    g_events = NULL;
+    g_path = NULL;
+    return;
+  }
+
+  g_pid = getpid();
+  g_origin = jshell_trace_now();
+  atexit(jshell_trace_dump);
+  jshell_trace_enabled = true;
+}
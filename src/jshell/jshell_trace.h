@@ -0,0 +1,52 @@
+#ifndef JSHELL_TRACE_H
+#define JSHELL_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+// Events kept per session; later ones are counted as dropped
+#define JSHELL_TRACE_CAPACITY 65536
+
+// Bytes of an event's detail (command name, path) that are kept
+#define JSHELL_TRACE_DETAIL_MAX 48
+
+
+// Phase timings of command lines (parse, expansion, lookup, spawn, wait,
+// builtin threads, capture), for finding where a slow line spends its time
+//
+// With JSHELL_TRACE=<file> set at startup, every instrumented phase is
+// recorded as a complete event into a lock-free buffer, which is written
+// to <file> at exit in Chrome trace format for chrome://tracing and
+// Perfetto. Unset, each probe is one branch on jshell_trace_enabled.
+
+// true once jshell_trace_init() found JSHELL_TRACE
+extern bool jshell_trace_enabled;
+
+// Read JSHELL_TRACE and, if set, arrange for the trace to be written at
+// exit; call once at startup, before any thread is started
+void jshell_trace_init(void);
+
+// Monotonic time in nanoseconds
+uint64_t jshell_trace_now(void);
+
+// Record a phase that started at start (from jshell_trace_begin())
+// name must be a string literal; detail is copied and may be NULL
+void jshell_trace_record(const char* name, const char* detail,
+                         uint64_t start);
+
+// Start timing a phase: its start time, or 0 when tracing is off
+static inline uint64_t jshell_trace_begin(void) {
+  return jshell_trace_enabled ? jshell_trace_now() : 0;
+}
+
+// Finish timing a phase begun with jshell_trace_begin()
+static inline void jshell_trace_end(const char* name, const char* detail,
+                                    uint64_t start) {
+  if (start != 0) {
+    jshell_trace_record(name, detail, start);
+  }
+}
+
+
+#endif
@@ -0,0 +1,157 @@
+/**
+ * @file jshell_usage.c
+ * @brief CPU time and memory accounting for commands and jobs.
+ *
+ * Finished children report their usage through wait4(), builtin threads
+ * through getrusage(RUSAGE_THREAD) and children that are still running
+ * through /proc/<pid>/stat and /proc/<pid>/status.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "jshell_usage.h"
+
+
+/**
+ * Get monotonic time in microseconds.
+ * @return Microseconds since an arbitrary fixed point.
+ */
+uint64_t jshell_usage_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+
+/**
+ * Convert a timeval to microseconds.
+ * @param tv Time value.
+ * @return Microseconds.
+ */
+static uint64_t timeval_us(const struct timeval* tv) {
+  return (uint64_t)tv->tv_sec * 1000000u + (uint64_t)tv->tv_usec;
+}
+
+
+/**
+ * Fill in CPU time and peak memory from a struct rusage.
+ * @param usage Usage to fill in; wall_us is not touched.
+ * @param ru Resource usage from wait4() or getrusage().
+ */
+void jshell_usage_from_rusage(JShellUsage* usage, const struct rusage* ru) {
+  usage->user_us = timeval_us(&ru->ru_utime);
+  usage->sys_us = timeval_us(&ru->ru_stime);
+  usage->max_rss_kb = ru->ru_maxrss;
+}
+
+
+/**
+ * Get the CPU time and peak memory of the calling thread.
+ * @param usage Usage to fill in; wall_us is not touched.
+ */
+void jshell_usage_of_thread(JShellUsage* usage) {
+  struct rusage ru;
+  if (getrusage(RUSAGE_THREAD, &ru) == 0) {
+    jshell_usage_from_rusage(usage, &ru);
+  }
+}
+
+
+/**
+ * Read the peak resident set size of a process.
+ * @param pid Process ID.
+ * @return VmHWM in kilobytes, or 0 if unknown.
+ */
+static long read_peak_rss(pid_t pid) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+  FILE* file = fopen(path, "r");
+  if (file == NULL) {
+    return 0;
+  }
+
+  char line[256];
+  long peak = 0;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    if (strncmp(line, "VmHWM:", 6) == 0) {
+      peak = strtol(line + 6, NULL, 10);
+      break;
+    }
+  }
+  fclose(file);
+  return peak;
+}
+
+
+/**
+ * Get the CPU time and peak memory of a running child from /proc.
+ * @param pid Process ID.
+ * @param usage Usage to fill in; wall_us is not touched.
+ * @return true on success, false if the process cannot be read.
+ */
+bool jshell_usage_of_pid(pid_t pid, JShellUsage* usage) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+  FILE* file = fopen(path, "r");
+  if (file == NULL) {
+    return false;
+  }
+
+  char line[1024];
+  bool ok = fgets(line, sizeof(line), file) != NULL;
+  fclose(file);
+  if (!ok) {
+    return false;
+  }
+
+  /* The command name may hold spaces and parentheses; skip past it */
+  char* fields = strrchr(line, ')');
+  unsigned long long utime;
+  unsigned long long stime;
+  if (fields == NULL
+      || sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+                            "%llu %llu", &utime, &stime) != 2) {
+    return false;
+  }
+
+  long ticks = sysconf(_SC_CLK_TCK);
+  if (ticks <= 0) {
+    ticks = 100;
+  }
+  usage->user_us = utime * 1000000u / (unsigned long long)ticks;
+  usage->sys_us = stime * 1000000u / (unsigned long long)ticks;
+  usage->max_rss_kb = read_peak_rss(pid);
+  return true;
+}
+
+
+/**
+ * Add the CPU time of one usage to another and keep the larger peak.
+ * @param total Accumulated usage; wall_us is not touched.
+ * @param other Usage to add.
+ */
+void jshell_usage_add(JShellUsage* total, const JShellUsage* other) {
+  total->user_us += other->user_us;
+  total->sys_us += other->sys_us;
+  if (other->max_rss_kb > total->max_rss_kb) {
+    total->max_rss_kb = other->max_rss_kb;
+  }
+}
+
+
+/**
+ * Write usage as JSON object members, without the braces.
+ * @param out Output stream.
+ * @param usage Usage to write.
+ */
+void jshell_usage_write_json(FILE* out, const JShellUsage* usage) {
+  fprintf(out, "\"wall_ms\": %.3f, \"user_ms\": %.3f, \"sys_ms\": %.3f, "
+               "\"max_rss_kb\": %ld",
+          (double)usage->wall_us / 1000.0, (double)usage->user_us / 1000.0,
+          (double)usage->sys_us / 1000.0, usage->max_rss_kb);
+}
@@ -0,0 +1,43 @@
+#ifndef JSHELL_USAGE_H
+#define JSHELL_USAGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+
+// Resources used by a process, a builtin thread or a whole job
+typedef struct {
+  uint64_t wall_us;     // Elapsed time
+  uint64_t user_us;     // CPU time in user mode
+  uint64_t sys_us;      // CPU time in the kernel
+  long max_rss_kb;      // Peak resident set size
+} JShellUsage;
+
+
+// Monotonic time in microseconds
+uint64_t jshell_usage_now(void);
+
+// Fill in the CPU time and peak memory of usage from a struct rusage
+// (from wait4() or getrusage()); wall_us is left alone
+void jshell_usage_from_rusage(JShellUsage* usage, const struct rusage* ru);
+
+// CPU time and peak memory of the calling thread so far
+// max_rss_kb is the peak of the whole shell, which threads share
+void jshell_usage_of_thread(JShellUsage* usage);
+
+// CPU time and peak memory of a child that is still running, from /proc
+// Returns false if the process is gone or /proc cannot be read
+bool jshell_usage_of_pid(pid_t pid, JShellUsage* usage);
+
+// Add the CPU time of other to total and keep the larger peak memory
+// wall_us is left alone, since stages of one job overlap
+void jshell_usage_add(JShellUsage* total, const JShellUsage* other);
+
+// Write usage as JSON members: "wall_ms": ..., "max_rss_kb": ...
+void jshell_usage_write_json(FILE* out, const JShellUsage* usage);
+
+
+#endif
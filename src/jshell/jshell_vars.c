@@ -0,0 +1,492 @@
+/**
+ * @file jshell_vars.c
+ * @brief Shell variable store with a lazily synchronized environment.
+ *
+ * setenv() and unsetenv() scan environ linearly and may reallocate it, and
+ * getenv() scans it again on every read, so scripts that assign in loops
+ * spent their time in environ churn. Variables now live in a hash map;
+ * assignments only touch the map, and a shell-local variable never reaches
+ * environ at all. Changes to exported variables are recorded and applied
+ * to environ in one pass when the next command is launched, which is the
+ * first point anything outside the shell can observe them.
+ *
+ * environ is still the exported environment (rather than an array owned
+ * here) because linked apps run in-process and read it through getenv(),
+ * possibly on threads that outlive a change; glibc never frees strings set
+ * by setenv(), so those readers stay safe.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jshell_vars.h"
+#include "utils/jbox_utils.h"
+
+
+#define VARS_BUCKETS 256
+
+
+extern char** environ;
+
+
+/** A shell variable */
+typedef struct ShellVar {
+  char* name;
+  char* value;
+  bool exported;
+  bool env_dirty;              /* environ does not match yet */
+  struct ShellVar* bucket_next;
+  struct ShellVar* prev;       /* Definition order, for the environ sync */
+  struct ShellVar* next;
+} ShellVar;
+
+
+static pthread_mutex_t g_vars_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static ShellVar* g_buckets[VARS_BUCKETS];
+static ShellVar* g_first = NULL;
+static ShellVar* g_last = NULL;
+
+/** Exported variables removed since the last sync, to unsetenv() */
+static char** g_removed = NULL;
+static size_t g_removed_count = 0;
+static size_t g_removed_capacity = 0;
+
+/** Bumped by every change, and by changes to exported variables */
+static unsigned long g_generation = 0;
+static unsigned long g_env_generation = 0;
+static unsigned long g_synced_generation = 0;
+
+
+/**
+ * Compute the bucket for a variable name (FNV-1a).
+ * @param name Variable name.
+ * @return Bucket index.
+ */
+static size_t vars_hash(const char* name) {
+  unsigned long hash = 2166136261UL;
+  for (const unsigned char* p = (const unsigned char*)name; *p; p++) {
+    hash ^= *p;
+    hash *= 16777619UL;
+  }
+  return hash % VARS_BUCKETS;
+}
+
+
+/**
+ * Check that a name can be stored in the environment.
+ * @param name Variable name.
+ * @return true if it is non-empty and has no '='.
+ */
+static bool valid_name(const char* name) {
+  return name != NULL && name[0] != '\0' && strchr(name, '=') == NULL;
+}
+
+
+/**
+ * Find a variable. Caller holds g_vars_lock.
+ * @param name Variable name.
+ * @return The variable, or NULL.
+ */
+static ShellVar* vars_find(const char* name) {
+  for (ShellVar* var = g_buckets[vars_hash(name)]; var != NULL;
+       var = var->bucket_next) {
+    if (strcmp(var->name, name) == 0) {
+      return var;
+    }
+  }
+  return NULL;
+}
+
+
+/**
+ * Record a change to an exported variable. Caller holds g_vars_lock.
+ * @param var The variable, which environ must be updated to match.
+ */
+static void mark_env_dirty(ShellVar* var) {
+  var->env_dirty = true;
+  g_env_generation++;
+}
+
+
+/**
+ * Create a variable and link it in. Caller holds g_vars_lock.
+ * @param name Variable name.
+ * @param value Initial value.
+ * @return The variable, or NULL on allocation failure.
+ */
+static ShellVar* vars_insert(const char* name, const char* value) {
+  ShellVar* var = calloc(1, sizeof(ShellVar));
+  if (var == NULL) {
+    return NULL;
+  }
+  var->name = strdup(name);
+  var->value = strdup(value);
+  if (var->name == NULL || var->value == NULL) {
+    free(var->name);
+    free(var->value);
+    free(var);
+    return NULL;
+  }
+
+  size_t bucket = vars_hash(name);
+  var->bucket_next = g_buckets[bucket];
+  g_buckets[bucket] = var;
+
+  var->prev = g_last;
+  if (g_last != NULL) {
+    g_last->next = var;
+  } else {
+    g_first = var;
+  }
+  g_last = var;
+  return var;
+}
+
+
+/**
+ * Unlink and free a variable. Caller holds g_vars_lock.
+ * @param var The variable.
+ * @param name Its name, for the bucket (var->name may already be gone).
+ */
+static void vars_remove(ShellVar* var, const char* name) {
+  ShellVar** link = &g_buckets[vars_hash(name)];
+  while (*link != var) {
+    link = &(*link)->bucket_next;
+  }
+  *link = var->bucket_next;
+
+  if (var->prev != NULL) {
+    var->prev->next = var->next;
+  } else {
+    g_first = var->next;
+  }
+  if (var->next != NULL) {
+    var->next->prev = var->prev;
+  } else {
+    g_last = var->prev;
+  }
+
+  free(var->name);
+  free(var->value);
+  free(var);
+}
+
+
+/**
+ * Import the process environment; every variable starts out exported.
+ */
+void jshell_vars_init(void) {
+  pthread_mutex_lock(&g_vars_lock);
+  for (char** e = environ; e != NULL && *e != NULL; e++) {
+    char* eq = strchr(*e, '=');
+    if (eq == NULL || eq == *e) {
+      continue;
+    }
+
+    size_t name_len = (size_t)(eq - *e);
+    char name[name_len + 1];
+    memcpy(name, *e, name_len);
+    name[name_len] = '\0';
+
+    /* environ may list a name twice; getenv() sees the first one */
+    if (vars_find(name) != NULL) {
+      continue;
+    }
+    ShellVar* var = vars_insert(name, eq + 1);
+    if (var != NULL) {
+      var->exported = true;
+    }
+  }
+  g_synced_generation = g_env_generation;
+  pthread_mutex_unlock(&g_vars_lock);
+
+  DPRINT("Imported the environment into the variable store");
+}
+
+
+/**
+ * Look up a variable's value.
+ *
+ * Only the main thread changes variables, so the main thread may use the
+ * returned pointer until it changes the variable itself.
+ *
+ * @param name Variable name.
+ * @return The value, or NULL if the variable is not set.
+ */
+const char* jshell_var_get(const char* name) {
+  if (name == NULL) {
+    return NULL;
+  }
+  pthread_mutex_lock(&g_vars_lock);
+  ShellVar* var = vars_find(name);
+  const char* value = var != NULL ? var->value : NULL;
+  pthread_mutex_unlock(&g_vars_lock);
+  return value;
+}
+
+
+/**
+ * Copy a variable's value, for readers off the main thread.
+ * @param name Variable name.
+ * @return Malloc'd value, or NULL if it is not set (or out of memory).
+ */
+char* jshell_var_dup(const char* name) {
+  if (name == NULL) {
+    return NULL;
+  }
+  pthread_mutex_lock(&g_vars_lock);
+  ShellVar* var = vars_find(name);
+  char* value = var != NULL ? strdup(var->value) : NULL;
+  pthread_mutex_unlock(&g_vars_lock);
+  return value;
+}
+
+
+/**
+ * Set a variable.
+ *
+ * A new variable is shell-local unless JSHELL_VAR_EXPORT is given; an
+ * existing one keeps its export state. Only changes to exported variables
+ * advance the environment generation.
+ *
+ * @param name Variable name.
+ * @param value New value.
+ * @param flags JSHELL_VAR_EXPORT or 0.
+ * @return 0 on success, -1 with errno set on failure.
+ */
+int jshell_var_set(const char* name, const char* value, int flags) {
+  if (!valid_name(name) || value == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  bool export = (flags & JSHELL_VAR_EXPORT) != 0;
+
+  pthread_mutex_lock(&g_vars_lock);
+  ShellVar* var = vars_find(name);
+  if (var == NULL) {
+    var = vars_insert(name, value);
+    if (var == NULL) {
+      pthread_mutex_unlock(&g_vars_lock);
+      errno = ENOMEM;
+      return -1;
+    }
+    var->exported = export;
+  } else if (strcmp(var->value, value) != 0) {
+    char* copy = strdup(value);
+    if (copy == NULL) {
+      pthread_mutex_unlock(&g_vars_lock);
+      errno = ENOMEM;
+      return -1;
+    }
+    free(var->value);
+    var->value = copy;
+  } else if (!export || var->exported) {
+    pthread_mutex_unlock(&g_vars_lock);
+    return 0;                   /* Nothing changed */
+  }
+
+  g_generation++;
+  if (export) {
+    var->exported = true;
+  }
+  if (var->exported) {
+    mark_env_dirty(var);
+  }
+  pthread_mutex_unlock(&g_vars_lock);
+  return 0;
+}
+
+
+/**
+ * Export an existing shell variable.
+ * @param name Variable name.
+ * @return 0 on success, -1 with errno ENOENT if it is not set.
+ */
+int jshell_var_export(const char* name) {
+  if (!valid_name(name)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  pthread_mutex_lock(&g_vars_lock);
+  ShellVar* var = vars_find(name);
+  if (var == NULL) {
+    pthread_mutex_unlock(&g_vars_lock);
+    errno = ENOENT;
+    return -1;
+  }
+  if (!var->exported) {
+    var->exported = true;
+    g_generation++;
+    mark_env_dirty(var);
+  }
+  pthread_mutex_unlock(&g_vars_lock);
+  return 0;
+}
+
+
+/**
+ * Remove a variable. An exported one is queued for removal from environ.
+ * @param name Variable name.
+ * @return 0 on success, -1 with errno set on failure.
+ */
+int jshell_var_unset(const char* name) {
+  if (!valid_name(name)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  pthread_mutex_lock(&g_vars_lock);
+  ShellVar* var = vars_find(name);
+  if (var == NULL) {
+    pthread_mutex_unlock(&g_vars_lock);
+    return 0;
+  }
+
+  if (var->exported) {
+    if (g_removed_count == g_removed_capacity) {
+      size_t capacity = g_removed_capacity ? g_removed_capacity * 2 : 8;
+      char** grown = realloc(g_removed, capacity * sizeof(char*));
+      if (grown == NULL) {
+        pthread_mutex_unlock(&g_vars_lock);
+        errno = ENOMEM;
+        return -1;
+      }
+      g_removed = grown;
+      g_removed_capacity = capacity;
+    }
+    /* The queue takes over the name; vars_remove() frees the rest */
+    g_removed[g_removed_count++] = var->name;
+    var->name = NULL;
+    g_env_generation++;
+  }
+
+  g_generation++;
+  vars_remove(var, name);
+  pthread_mutex_unlock(&g_vars_lock);
+  return 0;
+}
+
+
+/**
+ * Check whether a variable is set and exported.
+ * @param name Variable name.
+ * @return true if it is exported.
+ */
+bool jshell_var_is_exported(const char* name) {
+  if (name == NULL) {
+    return false;
+  }
+  pthread_mutex_lock(&g_vars_lock);
+  ShellVar* var = vars_find(name);
+  bool exported = var != NULL && var->exported;
+  pthread_mutex_unlock(&g_vars_lock);
+  return exported;
+}
+
+
+/**
+ * Get the variable generation.
+ * @return Counter advanced by every change to a variable.
+ */
+unsigned long jshell_vars_generation(void) {
+  pthread_mutex_lock(&g_vars_lock);
+  unsigned long generation = g_generation;
+  pthread_mutex_unlock(&g_vars_lock);
+  return generation;
+}
+
+
+/**
+ * Apply pending exported-variable changes to environ. Caller holds
+ * g_vars_lock.
+ */
+static void sync_environ_locked(void) {
+  if (g_synced_generation == g_env_generation) {
+    return;
+  }
+
+  for (size_t i = 0; i < g_removed_count; i++) {
+    unsetenv(g_removed[i]);
+    free(g_removed[i]);
+  }
+  g_removed_count = 0;
+
+  size_t written = 0;
+  for (ShellVar* var = g_first; var != NULL; var = var->next) {
+    if (var->env_dirty) {
+      if (setenv(var->name, var->value, 1) != 0) {
+        perror("setenv");
+      }
+      var->env_dirty = false;
+      written++;
+    }
+  }
+
+  DPRINT("Synced %zu variable(s) to environ (generation %lu)", written,
+         g_env_generation);
+  g_synced_generation = g_env_generation;
+}
+
+
+/**
+ * Bring environ up to date with the exported variables.
+ *
+ * Removals are applied first, so a variable that was unset and then set
+ * again ends up set. Only variables changed since the last sync are
+ * written, and nothing is done while the generation is unchanged.
+ */
+void jshell_vars_sync_environ(void) {
+  pthread_mutex_lock(&g_vars_lock);
+  sync_environ_locked();
+  pthread_mutex_unlock(&g_vars_lock);
+}
+
+
+/**
+ * Show or hide the shell-local variables in environ.
+ *
+ * Pending exported changes are applied first, so while locals are exposed
+ * environ holds every variable the shell has.
+ *
+ * @param expose true to add the locals, false to remove them again.
+ */
+void jshell_vars_expose_locals(bool expose) {
+  pthread_mutex_lock(&g_vars_lock);
+  sync_environ_locked();
+  for (ShellVar* var = g_first; var != NULL; var = var->next) {
+    if (var->exported) {
+      continue;
+    }
+    if (expose) {
+      setenv(var->name, var->value, 1);
+    } else {
+      unsetenv(var->name);
+    }
+  }
+  pthread_mutex_unlock(&g_vars_lock);
+}
+
+
+/**
+ * Free all variables and the pending removals.
+ */
+void jshell_vars_cleanup(void) {
+  pthread_mutex_lock(&g_vars_lock);
+  while (g_first != NULL) {
+    vars_remove(g_first, g_first->name);
+  }
+  for (size_t i = 0; i < g_removed_count; i++) {
+    free(g_removed[i]);
+  }
+  free(g_removed);
+  g_removed = NULL;
+  g_removed_count = 0;
+  g_removed_capacity = 0;
+  pthread_mutex_unlock(&g_vars_lock);
+}
@@ -0,0 +1,60 @@
+#ifndef JSHELL_VARS_H
+#define JSHELL_VARS_H
+
+#include <stdbool.h>
+
+
+// Shell variables: name -> value, each either shell-local or exported
+// Only exported variables reach the environment of commands, and the
+// process environment is brought up to date lazily, when a command is
+// launched, rather than on every assignment
+
+
+// jshell_var_set flag: export the variable (otherwise its export state
+// is kept, and new variables are shell-local)
+#define JSHELL_VAR_EXPORT 0x1
+
+
+// Import the process environment as exported variables
+void jshell_vars_init(void);
+
+// Value of a variable, or NULL if it is not set
+// Main thread only; the pointer is valid until the variable changes
+const char* jshell_var_get(const char* name);
+
+// Malloc'd copy of a variable's value, or NULL; safe from any thread
+char* jshell_var_dup(const char* name);
+
+// Set a variable
+// Returns 0 on success, -1 with errno set (EINVAL for a bad name)
+int jshell_var_set(const char* name, const char* value, int flags);
+
+// Export an existing variable
+// Returns 0 on success, -1 with errno ENOENT if it is not set
+int jshell_var_export(const char* name);
+
+// Remove a variable; removing an unset variable succeeds
+// Returns 0 on success, -1 with errno EINVAL for a bad name
+int jshell_var_unset(const char* name);
+
+// Whether a variable is set and exported
+bool jshell_var_is_exported(const char* name);
+
+// Counter bumped whenever any variable changes, for caches of values
+unsigned long jshell_vars_generation(void);
+
+// Apply exported-variable changes made since the last call to the
+// process environment (environ); a no-op while nothing changed
+// Called before commands are launched
+void jshell_vars_sync_environ(void);
+
+// Temporarily put shell-local variables into environ (expose true) and
+// take them out again (expose false), for libc code that reads variables
+// itself, such as wordexp(); main thread only
+void jshell_vars_expose_locals(bool expose);
+
+// Free all variables (the process environment is left as it is)
+void jshell_vars_cleanup(void);
+
+
+#endif
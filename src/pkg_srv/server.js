@@ -1,6 +1,8 @@
 const express = require('express');
+const crypto = require('crypto');
 const fs = require('fs');
 const path = require('path');
+const zlib = require('zlib');
 
 const app = express();
 const PORT = process.env.PORT || 3000;
@@ -9,15 +11,121 @@ const PORT = process.env.PORT || 3000;
 const PROJECT_ROOT = path.join(__dirname, '..', '..');
 const DOWNLOADS_DIR = path.join(PROJECT_ROOT, 'srv', 'pkg_repository', 'downloads');
 const MANIFEST_PATH = path.join(PROJECT_ROOT, 'srv', 'pkg_repository', 'pkg_manifest.json');
+const STATIC_DIR = path.join(PROJECT_ROOT, 'srv', 'pkg_repository', 'static');
 
 // Load packages from manifest file
 let packages = [];
 
+// The GET /packages response, built once per load: clients poll it for
+// updates, so it is served from memory with a validator and precompressed
+let listing = null;
+
+// GET /packages/:name responses by package name, built with the listing
+let byName = new Map();
+
+function etagOf(body) {
+  return `"${crypto.createHash('sha256').update(body).digest('base64url')}"`;
+}
+
+function buildListing() {
+  const body = Buffer.from(JSON.stringify({
+    status: "ok",
+    packages: packages
+  }));
+  const etag = etagOf(body);
+  const unchanged = listing && listing.etag === etag;
+  listing = {
+    body: body,
+    gzip: zlib.gzipSync(body, { level: zlib.constants.Z_BEST_COMPRESSION }),
+    br: zlib.brotliCompressSync(body, {
+      params: { [zlib.constants.BROTLI_PARAM_QUALITY]: 11 }
+    }),
+    etag: etag,
+    // Keep the date across reloads that change nothing
+    lastModified: unchanged ? listing.lastModified : new Date().toUTCString()
+  };
+
+  byName = new Map();
+  for (const pkg of packages) {
+    if (byName.has(pkg.name)) {
+      continue;  // The first entry of a name wins, as in the listing
+    }
+    const pkgBody = Buffer.from(JSON.stringify({
+      status: "ok",
+      package: pkg
+    }));
+    byName.set(pkg.name, {
+      version: pkg.latestVersion,
+      body: pkgBody,
+      etag: etagOf(pkgBody),
+      lastModified: listing.lastModified
+    });
+  }
+}
+
+// Whether a download URL served from DOWNLOADS_DIR names a file that is
+// there. URLs elsewhere are taken as they are.
+function downloadExists(url) {
+  let pathname;
+  try {
+    pathname = new URL(url).pathname;
+  } catch (err) {
+    return false;
+  }
+  if (!pathname.startsWith('/downloads/')) {
+    return true;
+  }
+  const file = decodeURIComponent(pathname.slice('/downloads/'.length));
+  return fs.existsSync(path.join(DOWNLOADS_DIR, path.basename(file)));
+}
+
+// Each package may list prebuilt tarballs in "binaries", one per
+// platform tag ({platform, downloadUrl, sha256}). Clients install the one
+// for their platform instead of compiling the sources, so one whose file
+// is missing is dropped here: the client then falls back to the source
+// tarball rather than failing on a 404.
+function checkBinaries(pkgs) {
+  let count = 0;
+  for (const pkg of pkgs) {
+    if (!Array.isArray(pkg.binaries)) {
+      delete pkg.binaries;
+      continue;
+    }
+    pkg.binaries = pkg.binaries.filter(b =>
+      b && typeof b.platform === 'string' && typeof b.downloadUrl === 'string'
+      && downloadExists(b.downloadUrl));
+    count += pkg.binaries.length;
+  }
+  return count;
+}
+
+// "deltas" lists patches from older versions to the latest
+// ({from, platform, downloadUrl, sha256}; platform only for prebuilt
+// packages). Clients fall back to the full tarball without one, so a
+// delta whose file is missing is dropped like a missing binary.
+function checkDeltas(pkgs) {
+  let count = 0;
+  for (const pkg of pkgs) {
+    if (!Array.isArray(pkg.deltas)) {
+      delete pkg.deltas;
+      continue;
+    }
+    pkg.deltas = pkg.deltas.filter(d =>
+      d && typeof d.from === 'string' && typeof d.downloadUrl === 'string'
+      && downloadExists(d.downloadUrl));
+    count += pkg.deltas.length;
+  }
+  return count;
+}
+
 function loadPackages() {
   try {
     const data = fs.readFileSync(MANIFEST_PATH, 'utf8');
     packages = JSON.parse(data);
-    console.log(`Loaded ${packages.length} packages from ${MANIFEST_PATH}`);
+    const binaries = checkBinaries(packages);
+    const deltas = checkDeltas(packages);
+    console.log(`Loaded ${packages.length} packages (${binaries} prebuilt, ` +
+                `${deltas} deltas) from ${MANIFEST_PATH}`);
   } catch (err) {
     if (err.code === 'ENOENT') {
       console.warn(`Warning: ${MANIFEST_PATH} not found. Run 'make packages' to generate it.`);
@@ -27,6 +135,7 @@ function loadPackages() {
       packages = [];
     }
   }
+  buildListing();
 }
 
 // Load packages at startup
@@ -35,32 +144,71 @@ loadPackages();
 // Middleware for JSON parsing
 app.use(express.json());
 
-// Serve package downloads as static files
-app.use('/downloads', express.static(DOWNLOADS_DIR));
+// Serve package downloads as static files. A tarball's name carries its
+// version and never changes content, so clients and proxies may keep it
+// for good; byte ranges let interrupted downloads resume.
+app.use('/downloads', express.static(DOWNLOADS_DIR, {
+  maxAge: '1y',
+  immutable: true,
+  acceptRanges: true
+}));
+
+// Logging middleware. Lines are queued and written once per turn of the
+// event loop, after the responses of that turn, rather than one write per
+// request.
+const logQueue = [];
+
+function flushLog() {
+  process.stdout.write(logQueue.join(''));
+  logQueue.length = 0;
+}
 
-// Logging middleware
 app.use((req, res, next) => {
-  console.log(`${new Date().toISOString()} ${req.method} ${req.path}`);
+  if (logQueue.push(`${new Date().toISOString()} ${req.method} ${req.path}\n`)
+      === 1) {
+    setImmediate(flushLog);
+  }
   next();
 });
 
+// Sends a prebuilt JSON response, or 304 if the client's copy is current
+function sendPrebuilt(req, res, entry) {
+  res.set({
+    'ETag': entry.etag,
+    'Last-Modified': entry.lastModified,
+    'Cache-Control': 'no-cache',
+    'Vary': 'Accept-Encoding'
+  });
+  if (req.fresh) {
+    res.status(304).end();
+    return;
+  }
+
+  res.type('json');
+  const encodings = [entry.br && 'br', entry.gzip && 'gzip', 'identity'];
+  const encoding = req.acceptsEncodings(encodings.filter(Boolean));
+  if (encoding === 'br' || encoding === 'gzip') {
+    res.set('Content-Encoding', encoding);
+    res.send(entry[encoding]);
+  } else {
+    res.send(entry.body);
+  }
+}
+
 // GET /packages - List all packages
+// Answers If-None-Match / If-Modified-Since with 304 when the listing has
+// not changed, and sends it brotli- or gzip-compressed to clients that
+// accept that.
 app.get('/packages', (req, res) => {
-  res.json({
-    status: "ok",
-    packages: packages
-  });
+  sendPrebuilt(req, res, listing);
 });
 
 // GET /packages/:name - Get specific package
 app.get('/packages/:name', (req, res) => {
-  const pkg = packages.find(p => p.name === req.params.name);
+  const entry = byName.get(req.params.name);
 
-  if (pkg) {
-    res.json({
-      status: "ok",
-      package: pkg
-    });
+  if (entry) {
+    sendPrebuilt(req, res, entry);
   } else {
     res.status(404).json({
       status: "error",
@@ -69,6 +217,33 @@ app.get('/packages/:name', (req, res) => {
   }
 });
 
+// POST /packages/versions - Latest versions of the named packages
+// Takes {"names": [...]} and answers {"status": "ok", "packages":
+// [{name, latestVersion}], "missing": [...]}, so a client checks all its
+// installed packages for updates in one round trip.
+app.post('/packages/versions', (req, res) => {
+  const names = req.body && req.body.names;
+  if (!Array.isArray(names) || !names.every(n => typeof n === 'string')) {
+    res.status(400).json({
+      status: "error",
+      message: "expected {\"names\": [...]}"
+    });
+    return;
+  }
+
+  const found = [];
+  const missing = [];
+  for (const name of names) {
+    const entry = byName.get(name);
+    if (entry) {
+      found.push({ name: name, latestVersion: entry.version });
+    } else {
+      missing.push(name);
+    }
+  }
+  res.json({ status: "ok", packages: found, missing: missing });
+});
+
 // POST /reload - Reload package manifest (useful for development)
 app.post('/reload', (req, res) => {
   loadPackages();
@@ -78,14 +253,32 @@ app.post('/reload', (req, res) => {
   });
 });
 
+// The static layout generate-pkg-manifest.sh writes (see static.js), so
+// this server is one more mirror of it. Listings and blobs are named by
+// their digest and never change; index.json and the package files do.
+app.use(express.static(STATIC_DIR, {
+  index: false,
+  redirect: false,
+  setHeaders: (res, file) => {
+    const rel = path.relative(STATIC_DIR, file);
+    if (rel.startsWith('blobs') || rel.startsWith('listing')) {
+      res.set('Cache-Control', 'public, max-age=31536000, immutable');
+    } else {
+      res.set('Cache-Control', 'no-cache');
+    }
+  }
+}));
+
 // Start server
 app.listen(PORT, () => {
   console.log(`jshell package registry server running on http://localhost:${PORT}`);
   console.log(`Available endpoints:`);
   console.log(`  GET  /packages             - List all packages`);
   console.log(`  GET  /packages/:name       - Get package by name`);
+  console.log(`  POST /packages/versions    - Latest versions of named packages`);
   console.log(`  GET  /downloads/:filename  - Download package tarball`);
   console.log(`  POST /reload               - Reload package manifest`);
+  console.log(`  GET  /index.json           - Static registry layout`);
   console.log(`Downloads directory: ${DOWNLOADS_DIR}`);
   console.log(`Manifest file: ${MANIFEST_PATH}`);
 });
@@ -0,0 +1,148 @@
+// Static registry layout
+//
+// Writes the registry as plain files that any static HTTP server or CDN
+// can serve, so clients need not reach the Node server at all:
+//
+//   index.json                 {"format", "generation", "listing", "count"}
+//   listing/<sha256>.json      the GET /packages response
+//   packages/<xx>/<name>.json  the GET /packages/<name> response, where xx
+//                              is the first byte of sha256(name) in hex
+//   blobs/<xx>/<sha256><ext>   tarballs and deltas, named by digest
+//
+// Download URLs in the listing and package files are relative to the
+// directory of index.json, so every mirror of the tree serves its own
+// copies. Everything but index.json and packages/ is immutable: a changed
+// listing or tarball gets a new name, and only index.json moves to it.
+// The generation in index.json goes up each time the listing changes,
+// which lets clients tell a stale mirror from a current one.
+//
+// Usage: node static.js MANIFEST DOWNLOADS_DIR OUT_DIR
+
+const crypto = require('crypto');
+const fs = require('fs');
+const path = require('path');
+
+const FORMAT = 1;
+
+function sha256(data) {
+  return crypto.createHash('sha256').update(data).digest('hex');
+}
+
+// Writes a file through a temporary name, so servers never send a
+// partial one
+function writeAtomic(file, data) {
+  fs.mkdirSync(path.dirname(file), { recursive: true });
+  const tmp = `${file}.tmp.${process.pid}`;
+  fs.writeFileSync(tmp, data);
+  fs.renameSync(tmp, file);
+}
+
+// Places a download under blobs/ by its digest and returns its relative
+// URL, or null if the file is not in downloadsDir
+function addBlob(url, downloadsDir, outDir) {
+  let pathname;
+  try {
+    pathname = new URL(url).pathname;
+  } catch (err) {
+    return null;
+  }
+  if (!pathname.startsWith('/downloads/')) {
+    return null;
+  }
+  const name = path.basename(decodeURIComponent(pathname));
+  const src = path.join(downloadsDir, name);
+  if (!fs.existsSync(src)) {
+    return null;
+  }
+
+  const digest = sha256(fs.readFileSync(src));
+  const ext = name.endsWith('.tar.gz') ? '.tar.gz' : path.extname(name);
+  const rel = `blobs/${digest.slice(0, 2)}/${digest}${ext}`;
+  const dest = path.join(outDir, rel);
+  if (!fs.existsSync(dest)) {
+    fs.mkdirSync(path.dirname(dest), { recursive: true });
+    try {
+      fs.linkSync(src, dest);
+    } catch (err) {
+      fs.copyFileSync(src, dest);
+    }
+  }
+  return rel;
+}
+
+// Rewrites a package's download URLs to blobs, dropping binaries and
+// deltas whose file is missing as the server does
+function staticPackage(pkg, downloadsDir, outDir) {
+  const out = { ...pkg };
+  const main = pkg.downloadUrl && addBlob(pkg.downloadUrl, downloadsDir, outDir);
+  if (main) {
+    out.downloadUrl = main;
+  }
+  for (const key of ['binaries', 'deltas']) {
+    if (!Array.isArray(pkg[key])) {
+      continue;
+    }
+    out[key] = [];
+    for (const item of pkg[key]) {
+      const rel = item && item.downloadUrl
+                  && addBlob(item.downloadUrl, downloadsDir, outDir);
+      if (rel) {
+        out[key].push({ ...item, downloadUrl: rel });
+      }
+    }
+  }
+  return out;
+}
+
+function buildStatic(packages, downloadsDir, outDir) {
+  const listed = packages.map(pkg => staticPackage(pkg, downloadsDir, outDir));
+
+  const seen = new Set();
+  for (const pkg of listed) {
+    if (seen.has(pkg.name)) {
+      continue;  // The first entry of a name wins, as in the listing
+    }
+    seen.add(pkg.name);
+    const shard = sha256(pkg.name).slice(0, 2);
+    writeAtomic(path.join(outDir, 'packages', shard, `${pkg.name}.json`),
+                JSON.stringify({ status: 'ok', package: pkg }));
+  }
+
+  const body = JSON.stringify({ status: 'ok', packages: listed });
+  const listing = `listing/${sha256(body)}.json`;
+  if (!fs.existsSync(path.join(outDir, listing))) {
+    writeAtomic(path.join(outDir, listing), body);
+  }
+
+  let generation = 1;
+  try {
+    const previous = JSON.parse(
+      fs.readFileSync(path.join(outDir, 'index.json'), 'utf8'));
+    generation = previous.generation + (previous.listing === listing ? 0 : 1);
+  } catch (err) {
+    // First run
+  }
+
+  // Last, so the files it names are in place before it points at them
+  writeAtomic(path.join(outDir, 'index.json'), JSON.stringify({
+    format: FORMAT,
+    generation: generation,
+    listing: listing,
+    count: listed.length
+  }));
+  return generation;
+}
+
+module.exports = { buildStatic };
+
+if (require.main === module) {
+  const [manifest, downloadsDir, outDir] = process.argv.slice(2);
+  if (!manifest || !downloadsDir || !outDir) {
+    console.error('Usage: node static.js MANIFEST DOWNLOADS_DIR OUT_DIR');
+    process.exit(1);
+  }
+  const packages = JSON.parse(fs.readFileSync(manifest, 'utf8'));
+  const generation = buildStatic(packages, downloadsDir, outDir);
+  console.log(`Generated ${path.join(outDir, 'index.json')} ` +
+              `(generation ${generation})`);
+}
@@ -0,0 +1,547 @@
+/**
+ * @file jbox_aio.c
+ * @brief Sequential read-ahead over io_uring or a pread() thread pool.
+ *
+ * The reader owns JBOX_AIO_DEPTH buffers used round robin: block k of
+ * the file goes to slot k % JBOX_AIO_DEPTH. All slots are queued when
+ * the reader opens, and the slot the caller was lent is queued again for
+ * the block JBOX_AIO_DEPTH further on when the caller asks for the next
+ * one, so the reads in flight always run ahead of the caller in order.
+ *
+ * The io_uring backend talks to the kernel directly (no liburing): one
+ * ring of JBOX_AIO_DEPTH entries, the buffers registered once for
+ * IORING_OP_READ_FIXED, or plain IORING_OP_READ if registering is
+ * refused (RLIMIT_MEMLOCK on older kernels). Where io_uring_setup()
+ * fails (old kernel, seccomp, io_uring disabled by sysctl), one thread
+ * per slot waits for its slot to be queued and fills it with pread().
+ *
+ * Blocks are planned up to the file size seen at open. A short or empty
+ * block, or reaching that size, switches to plain read() calls from the
+ * current position, which follow a file that grows or shrinks meanwhile.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include "jbox_aio.h"
+
+
+/** Alignment of the buffers, for filesystems that want whole pages */
+#define AIO_BUFFER_ALIGN 4096
+
+
+typedef enum {
+  AIO_SYNC,                 /* Plain read() */
+  AIO_URING,
+  AIO_THREADS
+} aio_backend_t;
+
+enum {
+  SLOT_IDLE,                /* Free, or lent to the caller */
+  SLOT_QUEUED,              /* Read requested */
+  SLOT_DONE                 /* Read finished; result and error are set */
+};
+
+typedef struct {
+  off_t offset;
+  size_t len;
+  ssize_t result;
+  int error;
+  int state;
+} aio_slot_t;
+
+typedef struct {
+  int fd;
+  int fixed;                /* Buffers registered */
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_map;
+  void *cq_map;
+  size_t sq_map_size;
+  size_t cq_map_size;
+  size_t sqes_size;
+} aio_ring_t;
+
+typedef struct {
+  jbox_aio_t *aio;
+  int index;
+} aio_worker_t;
+
+struct jbox_aio {
+  int fd;
+  aio_backend_t backend;
+  int draining;             /* Planned blocks done; reading with read() */
+  size_t block;
+  char *buffers;            /* JBOX_AIO_DEPTH blocks, or one for AIO_SYNC */
+  off_t pos;                /* Offset just past the data returned */
+  off_t end;                /* File size at open */
+  off_t next_offset;        /* Offset of the next block to queue */
+  int current;              /* Slot of the next block to return */
+  int held;                 /* Slot lent to the caller, or -1 */
+  aio_slot_t slots[JBOX_AIO_DEPTH];
+  aio_ring_t ring;
+  aio_worker_t workers[JBOX_AIO_DEPTH];
+  pthread_t threads[JBOX_AIO_DEPTH];
+  int thread_count;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int stop;
+};
+
+
+/**
+ * Reads len bytes at offset unless the file ends first.
+ * @return Bytes read, or -1 on error (errno set)
+ */
+static ssize_t pread_full(int fd, char *buf, size_t len, off_t offset) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = pread(fd, buf + done, len - done, offset + (off_t)done);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    if (n == 0) break;
+    done += (size_t)n;
+  }
+  return (ssize_t)done;
+}
+
+
+/* ---- io_uring backend ---- */
+
+
+/**
+ * Unmaps and closes a ring.
+ */
+static void ring_teardown(aio_ring_t *ring) {
+  if (ring->sqes) munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_map && ring->cq_map != ring->sq_map) {
+    munmap(ring->cq_map, ring->cq_map_size);
+  }
+  if (ring->sq_map) munmap(ring->sq_map, ring->sq_map_size);
+  close(ring->fd);
+}
+
+
+/**
+ * Creates a ring for the reader and registers its buffers.
+ * @return 0 on success, -1 if io_uring is unavailable
+ */
+static int ring_setup(jbox_aio_t *aio) {
+  aio_ring_t *ring = &aio->ring;
+  memset(ring, 0, sizeof(*ring));
+
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  ring->fd = (int)syscall(__NR_io_uring_setup, JBOX_AIO_DEPTH, &p);
+  if (ring->fd < 0) return -1;
+
+  ring->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring->cq_map_size = p.cq_off.cqes +
+                      p.cq_entries * sizeof(struct io_uring_cqe);
+  int single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single) {
+    if (ring->cq_map_size > ring->sq_map_size) {
+      ring->sq_map_size = ring->cq_map_size;
+    }
+    ring->cq_map_size = ring->sq_map_size;
+  }
+
+  ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_map == MAP_FAILED) {
+    ring->sq_map = NULL;
+    goto fail;
+  }
+  if (single) {
+    ring->cq_map = ring->sq_map;
+  } else {
+    ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_CQ_RING);
+    if (ring->cq_map == MAP_FAILED) {
+      ring->cq_map = NULL;
+      goto fail;
+    }
+  }
+  ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    ring->sqes = NULL;
+    goto fail;
+  }
+
+  char *sq = ring->sq_map;
+  char *cq = ring->cq_map;
+  ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+  ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  struct iovec iov[JBOX_AIO_DEPTH];
+  for (int i = 0; i < JBOX_AIO_DEPTH; i++) {
+    iov[i].iov_base = aio->buffers + (size_t)i * aio->block;
+    iov[i].iov_len = aio->block;
+  }
+  ring->fixed = syscall(__NR_io_uring_register, ring->fd,
+                        IORING_REGISTER_BUFFERS, iov, JBOX_AIO_DEPTH) == 0;
+  return 0;
+
+fail:
+  ring_teardown(ring);
+  return -1;
+}
+
+
+/**
+ * Moves finished reads from the completion queue to their slots.
+ */
+static void ring_reap(jbox_aio_t *aio) {
+  aio_ring_t *ring = &aio->ring;
+  unsigned head = *ring->cq_head;
+  unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  while (head != tail) {
+    struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+    aio_slot_t *s = &aio->slots[cqe->user_data];
+    s->result = cqe->res < 0 ? -1 : cqe->res;
+    s->error = cqe->res < 0 ? -cqe->res : 0;
+    s->state = SLOT_DONE;
+    head++;
+  }
+  __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Submits the read of a queued slot.
+ */
+static void ring_submit(jbox_aio_t *aio, int slot) {
+  aio_ring_t *ring = &aio->ring;
+  aio_slot_t *s = &aio->slots[slot];
+  unsigned tail = *ring->sq_tail;
+  unsigned idx = tail & *ring->sq_mask;
+
+  struct io_uring_sqe *sqe = &ring->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = ring->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+  sqe->fd = aio->fd;
+  sqe->off = (uint64_t)s->offset;
+  sqe->addr = (uint64_t)(uintptr_t)(aio->buffers + (size_t)slot * aio->block);
+  sqe->len = (uint32_t)s->len;
+  sqe->buf_index = ring->fixed ? (uint16_t)slot : 0;
+  sqe->user_data = (uint64_t)slot;
+  ring->sq_array[idx] = idx;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  long n;
+  do {
+    n = syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0) {
+    s->result = -1;
+    s->error = errno;
+    s->state = SLOT_DONE;
+  }
+}
+
+
+/**
+ * Waits until a slot's read has finished.
+ */
+static void ring_wait(jbox_aio_t *aio, int slot) {
+  aio_slot_t *s = &aio->slots[slot];
+  for (;;) {
+    ring_reap(aio);
+    if (s->state != SLOT_QUEUED) return;
+    long n = syscall(__NR_io_uring_enter, aio->ring.fd, 0, 1,
+                     IORING_ENTER_GETEVENTS, NULL, 0);
+    if (n < 0 && errno != EINTR) {
+      /* The read may still complete; only a later wait can tell */
+      s->result = -1;
+      s->error = errno;
+      s->state = SLOT_DONE;
+      return;
+    }
+  }
+}
+
+
+/* ---- Thread backend ---- */
+
+
+/**
+ * Fills one slot with pread() each time it is queued.
+ */
+static void *aio_worker(void *arg) {
+  aio_worker_t *w = arg;
+  jbox_aio_t *aio = w->aio;
+  aio_slot_t *s = &aio->slots[w->index];
+  char *buf = aio->buffers + (size_t)w->index * aio->block;
+
+  pthread_mutex_lock(&aio->lock);
+  for (;;) {
+    while (!aio->stop && s->state != SLOT_QUEUED) {
+      pthread_cond_wait(&aio->cond, &aio->lock);
+    }
+    if (aio->stop) break;
+    off_t offset = s->offset;
+    size_t len = s->len;
+    pthread_mutex_unlock(&aio->lock);
+
+    ssize_t n = pread_full(aio->fd, buf, len, offset);
+    int error = n < 0 ? errno : 0;
+
+    pthread_mutex_lock(&aio->lock);
+    s->result = n;
+    s->error = error;
+    s->state = SLOT_DONE;
+    pthread_cond_broadcast(&aio->cond);
+  }
+  pthread_mutex_unlock(&aio->lock);
+  return NULL;
+}
+
+
+/**
+ * Starts one worker per slot.
+ * @return 0 on success, -1 if no thread could be started
+ */
+static int threads_setup(jbox_aio_t *aio) {
+  pthread_mutex_init(&aio->lock, NULL);
+  pthread_cond_init(&aio->cond, NULL);
+  for (int i = 0; i < JBOX_AIO_DEPTH; i++) {
+    aio->workers[i].aio = aio;
+    aio->workers[i].index = i;
+    if (pthread_create(&aio->threads[i], NULL, aio_worker,
+                       &aio->workers[i]) != 0) {
+      break;
+    }
+    aio->thread_count++;
+  }
+  if (aio->thread_count == JBOX_AIO_DEPTH) return 0;
+
+  /* Slots without a worker would never fill */
+  pthread_mutex_lock(&aio->lock);
+  aio->stop = 1;
+  pthread_cond_broadcast(&aio->cond);
+  pthread_mutex_unlock(&aio->lock);
+  for (int i = 0; i < aio->thread_count; i++) {
+    pthread_join(aio->threads[i], NULL);
+  }
+  aio->thread_count = 0;
+  pthread_cond_destroy(&aio->cond);
+  pthread_mutex_destroy(&aio->lock);
+  return -1;
+}
+
+
+/* ---- Common ---- */
+
+
+/**
+ * Queues the next planned block into a slot, or leaves the slot idle if
+ * every block has been queued.
+ */
+static void queue_slot(jbox_aio_t *aio, int slot) {
+  aio_slot_t *s = &aio->slots[slot];
+  if (aio->next_offset >= aio->end) {
+    s->state = SLOT_IDLE;
+    return;
+  }
+  size_t len = aio->block;
+  if ((off_t)len > aio->end - aio->next_offset) {
+    len = (size_t)(aio->end - aio->next_offset);
+  }
+
+  if (aio->backend == AIO_THREADS) pthread_mutex_lock(&aio->lock);
+  s->offset = aio->next_offset;
+  s->len = len;
+  s->state = SLOT_QUEUED;
+  if (aio->backend == AIO_THREADS) {
+    pthread_cond_broadcast(&aio->cond);
+    pthread_mutex_unlock(&aio->lock);
+  } else {
+    ring_submit(aio, slot);
+  }
+  aio->next_offset += (off_t)len;
+}
+
+
+/**
+ * Waits until a slot is no longer queued.
+ */
+static void wait_slot(jbox_aio_t *aio, int slot) {
+  if (aio->backend == AIO_URING) {
+    ring_wait(aio, slot);
+    return;
+  }
+  pthread_mutex_lock(&aio->lock);
+  while (aio->slots[slot].state == SLOT_QUEUED) {
+    pthread_cond_wait(&aio->cond, &aio->lock);
+  }
+  pthread_mutex_unlock(&aio->lock);
+}
+
+
+/**
+ * Waits for every read in flight and stops queueing more, so the
+ * buffers are free.
+ */
+static void drain(jbox_aio_t *aio) {
+  for (int i = 0; i < JBOX_AIO_DEPTH; i++) {
+    wait_slot(aio, i);
+    aio->slots[i].state = SLOT_IDLE;
+  }
+  aio->next_offset = aio->end;
+  aio->held = -1;
+}
+
+
+jbox_aio_t *jbox_aio_open(int fd, size_t block) {
+  jbox_aio_t *aio = calloc(1, sizeof(*aio));
+  if (!aio) return NULL;
+  aio->fd = fd;
+  aio->block = block ? block : JBOX_AIO_BLOCK;
+  aio->held = -1;
+  aio->backend = AIO_SYNC;
+
+  /* Only a regular file with more than a couple of blocks left gains
+   * from reads in flight */
+  struct stat st;
+  off_t start = -1;
+  int ahead = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+              (start = lseek(fd, 0, SEEK_CUR)) >= 0 &&
+              st.st_size - start > 2 * (off_t)aio->block;
+
+  size_t bytes = ahead ? JBOX_AIO_DEPTH * aio->block : aio->block;
+  void *buffers;
+  if (posix_memalign(&buffers, AIO_BUFFER_ALIGN, bytes) != 0) {
+    free(aio);
+    return NULL;
+  }
+  aio->buffers = buffers;
+  if (!ahead) return aio;
+
+  posix_fadvise(fd, start, 0, POSIX_FADV_SEQUENTIAL);
+  if (ring_setup(aio) == 0) {
+    aio->backend = AIO_URING;
+  } else if (threads_setup(aio) == 0) {
+    aio->backend = AIO_THREADS;
+  } else {
+    return aio;
+  }
+
+  aio->pos = start;
+  aio->end = st.st_size;
+  aio->next_offset = start;
+  for (int i = 0; i < JBOX_AIO_DEPTH; i++) {
+    queue_slot(aio, i);
+  }
+  return aio;
+}
+
+
+ssize_t jbox_aio_read(jbox_aio_t *aio, const char **data) {
+  if (aio->backend == AIO_SYNC || aio->draining) {
+    ssize_t n = read(aio->fd, aio->buffers, aio->block);
+    if (n > 0) {
+      *data = aio->buffers;
+      aio->pos += n;
+    }
+    return n;
+  }
+
+  if (aio->held >= 0) {
+    queue_slot(aio, aio->held);
+    aio->held = -1;
+  }
+
+  int slot = aio->current;
+  aio_slot_t *s = &aio->slots[slot];
+  wait_slot(aio, slot);
+  if (s->state == SLOT_IDLE || s->result == 0) {
+    /* Past the planned blocks, or the file shrank */
+    drain(aio);
+    aio->draining = 1;
+    if (lseek(aio->fd, aio->pos, SEEK_SET) < 0) return -1;
+    return jbox_aio_read(aio, data);
+  }
+  if (s->result < 0) {
+    errno = s->error;
+    return -1;
+  }
+
+  ssize_t n = s->result;
+  char *buf = aio->buffers + (size_t)slot * aio->block;
+  if ((size_t)n < s->len) {
+    /* A short read mid-file; finish the block before handing it out */
+    ssize_t more = pread_full(aio->fd, buf + n, s->len - (size_t)n,
+                              s->offset + n);
+    if (more < 0) return -1;
+    n += more;
+  }
+
+  s->state = SLOT_IDLE;
+  aio->held = slot;
+  aio->current = (slot + 1) % JBOX_AIO_DEPTH;
+  aio->pos += n;
+  *data = buf;
+  if ((size_t)n < s->len) {
+    /* The file ended early; what follows is read with read() */
+    drain(aio);
+    aio->draining = 1;
+    if (lseek(aio->fd, aio->pos, SEEK_SET) < 0) return -1;
+  }
+  return n;
+}
+
+
+void jbox_aio_close(jbox_aio_t *aio) {
+  if (!aio) return;
+
+  if (aio->backend != AIO_SYNC) {
+    if (!aio->draining) {
+      drain(aio);
+      lseek(aio->fd, aio->pos, SEEK_SET);
+    }
+    if (aio->backend == AIO_URING) {
+      ring_teardown(&aio->ring);
+    } else {
+      pthread_mutex_lock(&aio->lock);
+      aio->stop = 1;
+      pthread_cond_broadcast(&aio->cond);
+      pthread_mutex_unlock(&aio->lock);
+      for (int i = 0; i < aio->thread_count; i++) {
+        pthread_join(aio->threads[i], NULL);
+      }
+      pthread_cond_destroy(&aio->cond);
+      pthread_mutex_destroy(&aio->lock);
+    }
+  }
+
+  free(aio->buffers);
+  free(aio);
+}
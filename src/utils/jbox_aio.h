@@ -0,0 +1,57 @@
+#ifndef JBOX_AIO_H
+#define JBOX_AIO_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+
+/** Default bytes per read */
+#define JBOX_AIO_BLOCK (1024 * 1024)
+
+/** Reads kept in flight ahead of the caller */
+#define JBOX_AIO_DEPTH 4
+
+
+/**
+ * Sequential read-ahead over a file, for copies that have to pass data
+ * through user space (a terminal, TLS, JSON escaping, filesystems that
+ * refuse kernel copies).
+ *
+ * A regular file is read in blocks by JBOX_AIO_DEPTH concurrent reads
+ * into fixed buffers, so the device works on the next blocks while the
+ * caller writes out the current one. The reads go through io_uring with
+ * the buffers registered once, or where io_uring is unavailable through
+ * a pool of threads calling pread(). Pipes, terminals and small files
+ * are read with plain read() calls, since there is nothing to overlap.
+ */
+typedef struct jbox_aio jbox_aio_t;
+
+
+/**
+ * Start reading a descriptor from its current offset.
+ *
+ * @param fd Descriptor to read; not closed
+ * @param block Bytes per read, or 0 for JBOX_AIO_BLOCK
+ * @return Reader, or NULL if out of memory
+ */
+jbox_aio_t *jbox_aio_open(int fd, size_t block);
+
+/**
+ * Return the next block of data, in file order.
+ *
+ * @param aio Reader
+ * @param data Set to the block; valid until the next call
+ * @return Bytes in the block, 0 at end of file, -1 on error (errno set)
+ */
+ssize_t jbox_aio_read(jbox_aio_t *aio, const char **data);
+
+/**
+ * Stop reading, waiting for reads still in flight, and leave the
+ * descriptor's offset just past the data returned.
+ *
+ * @param aio Reader, or NULL
+ */
+void jbox_aio_close(jbox_aio_t *aio);
+
+
+#endif /* JBOX_AIO_H */
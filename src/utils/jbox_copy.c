@@ -0,0 +1,602 @@
+/**
+ * @file jbox_copy.c
+ * @brief File and directory tree copying for jbox applications.
+ *
+ * File data goes by the cheapest method available. Each method is tried
+ * only while nothing has been copied yet, so a method the kernel or
+ * filesystem rejects (EXDEV across filesystems, EOPNOTSUPP without
+ * reflink support, ...) falls through to the next one without leaving a
+ * partial copy behind. Kernel-side copies move at most
+ * JBOX_COPY_KERNEL_CHUNK per call so an interrupt is noticed promptly.
+ *
+ * A source with fewer blocks than its size has holes; only its data
+ * extents, found with SEEK_DATA/SEEK_HOLE, are copied, and the holes are
+ * left unwritten so the copy stays sparse. Other files are preallocated
+ * to their full size first, so the filesystem can lay them out in as few
+ * extents as possible.
+ *
+ * Trees are walked by jbox_walk(), whose threads create each directory
+ * as they reach it and copy the files they find in place, so separate
+ * subtrees are read and copied in parallel.
+ *
+ * JBOX_COPY_UPDATE makes a copy incremental, as rsync's default check
+ * does: a destination file of the same size and mtime as its source is
+ * taken to be unchanged and not opened, and files that are copied get
+ * the source's mtime.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+#include "jbox_aio.h"
+#include "jbox_copy.h"
+#include "jbox_remove.h"
+#include "jbox_signals.h"
+#include "jbox_walk.h"
+
+
+/** Bytes asked of copy_file_range/sendfile per call */
+#define JBOX_COPY_KERNEL_CHUNK (16 * 1024 * 1024)
+
+/** Size and alignment of the fallback copy buffer */
+#define JBOX_COPY_BUFFER_SIZE (1024 * 1024)
+#define JBOX_COPY_BUFFER_ALIGN 4096
+
+/** Result of one kernel copy method */
+enum {
+  COPY_DONE = 0,
+  COPY_ERROR = -1,
+  COPY_INTERRUPTED = -2,
+  COPY_UNSUPPORTED = -3,   /* Nothing copied; try the next method */
+};
+
+
+/**
+ * Whether an error from a kernel copy means "not here", not "failed".
+ * @param err errno from the call
+ */
+static int is_unsupported(int err) {
+  return err == EXDEV || err == EINVAL || err == ENOSYS ||
+         err == EOPNOTSUPP || err == ENOTSUP || err == EBADF ||
+         err == EPERM;
+}
+
+
+/**
+ * Copies with copy_file_range(), or with sendfile() when use_sendfile
+ * is set, from the current file offsets until EOF.
+ * @return COPY_DONE, COPY_ERROR, COPY_INTERRUPTED or
+ *         COPY_UNSUPPORTED
+ */
+static int copy_in_kernel(int src_fd, int dest_fd, int use_sendfile) {
+  off_t copied = 0;
+
+  for (;;) {
+    if (jbox_is_interrupted()) return COPY_INTERRUPTED;
+
+    ssize_t n = use_sendfile
+      ? sendfile(dest_fd, src_fd, NULL, JBOX_COPY_KERNEL_CHUNK)
+      : copy_file_range(src_fd, NULL, dest_fd, NULL, JBOX_COPY_KERNEL_CHUNK, 0);
+    if (n == 0) return COPY_DONE;
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (copied == 0 && is_unsupported(errno)) return COPY_UNSUPPORTED;
+      return COPY_ERROR;
+    }
+    copied += n;
+  }
+}
+
+
+/**
+ * Copies through user space from the current offsets until EOF, with
+ * the next reads already in flight while each block is written.
+ * @return 0 on success, -1 on error, -2 on interrupt
+ */
+static int copy_buffered(int src_fd, int dest_fd) {
+  jbox_aio_t *aio = jbox_aio_open(src_fd, 0);
+  if (!aio) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  int result = 0;
+  for (;;) {
+    if (jbox_is_interrupted()) {
+      result = -2;
+      break;
+    }
+
+    const char *p;
+    ssize_t n = jbox_aio_read(aio, &p);
+    if (n == 0) break;
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      result = -1;
+      break;
+    }
+
+    while (n > 0) {
+      ssize_t w = write(dest_fd, p, (size_t)n);
+      if (w < 0) {
+        if (errno == EINTR) continue;
+        result = -1;
+        break;
+      }
+      p += w;
+      n -= w;
+    }
+    if (result != 0) break;
+  }
+
+  int saved_errno = errno;
+  jbox_aio_close(aio);
+  errno = saved_errno;
+  return result;
+}
+
+
+/**
+ * Copies len bytes at offset from src_fd to the same offset in dest_fd,
+ * leaving both file offsets alone.
+ * @return 0 on success, -1 on error, -2 on interrupt
+ */
+static int copy_range(int src_fd, int dest_fd, off_t offset, off_t len) {
+  off_t in = offset, out = offset;
+  off_t end = offset + len;
+  int kernel = 1;
+  void *buffer = NULL;
+  int result = 0;
+
+  while (in < end) {
+    if (jbox_is_interrupted()) {
+      result = -2;
+      break;
+    }
+    size_t want = end - in > JBOX_COPY_KERNEL_CHUNK ? JBOX_COPY_KERNEL_CHUNK
+                                             : (size_t)(end - in);
+
+    if (kernel) {
+      ssize_t n = copy_file_range(src_fd, &in, dest_fd, &out, want, 0);
+      if (n > 0) continue;
+      if (n == 0) break;              /* Source shrank */
+      if (errno == EINTR) continue;
+      if (!is_unsupported(errno)) {
+        result = -1;
+        break;
+      }
+      kernel = 0;
+    }
+
+    if (!buffer &&
+        posix_memalign(&buffer, JBOX_COPY_BUFFER_ALIGN,
+                       JBOX_COPY_BUFFER_SIZE) != 0) {
+      buffer = NULL;
+      errno = ENOMEM;
+      result = -1;
+      break;
+    }
+    if (want > JBOX_COPY_BUFFER_SIZE) want = JBOX_COPY_BUFFER_SIZE;
+    ssize_t n = pread(src_fd, buffer, want, in);
+    if (n == 0) break;
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      result = -1;
+      break;
+    }
+    for (ssize_t done = 0; done < n; ) {
+      ssize_t w = pwrite(dest_fd, (char *)buffer + done, (size_t)(n - done),
+                         out + done);
+      if (w < 0) {
+        if (errno == EINTR) continue;
+        result = -1;
+        break;
+      }
+      done += w;
+    }
+    if (result != 0) break;
+    in += n;
+    out += n;
+  }
+
+  int saved_errno = errno;
+  free(buffer);
+  errno = saved_errno;
+  return result;
+}
+
+
+/**
+ * Copies only the data extents of a sparse file, then sets the size so a
+ * trailing hole is kept too.
+ * @return COPY_DONE, COPY_ERROR, COPY_INTERRUPTED, or
+ *         COPY_UNSUPPORTED if the filesystem cannot report holes
+ */
+static int copy_sparse(int src_fd, int dest_fd, off_t size) {
+  off_t pos = 0;
+
+  while (pos < size) {
+    off_t data = lseek(src_fd, pos, SEEK_DATA);
+    if (data < 0) {
+      if (errno == ENXIO) break;      /* Only a hole is left */
+      if (pos == 0 && is_unsupported(errno)) return COPY_UNSUPPORTED;
+      return COPY_ERROR;
+    }
+    off_t hole = lseek(src_fd, data, SEEK_HOLE);
+    if (hole < 0) return COPY_ERROR;
+    if (hole > size) hole = size;
+
+    int rc = copy_range(src_fd, dest_fd, data, hole - data);
+    if (rc != 0) return rc;
+    pos = hole;
+  }
+
+  return ftruncate(dest_fd, size) == 0 ? COPY_DONE : COPY_ERROR;
+}
+
+
+int jbox_copy_data(int src_fd, int dest_fd, const struct stat *st) {
+  off_t size = st->st_size;
+
+  if (size > 0) {
+    if (ioctl(dest_fd, FICLONE, src_fd) == 0) return 0;
+
+    int rc = COPY_UNSUPPORTED;
+    if ((off_t)st->st_blocks * 512 < size) {
+      rc = copy_sparse(src_fd, dest_fd, size);
+    } else {
+      /* Reserve the blocks up front; failure just means no preallocation */
+      fallocate(dest_fd, FALLOC_FL_KEEP_SIZE, 0, size);
+    }
+    if (rc == COPY_UNSUPPORTED) rc = copy_in_kernel(src_fd, dest_fd, 0);
+    if (rc == COPY_UNSUPPORTED) rc = copy_in_kernel(src_fd, dest_fd, 1);
+    if (rc != COPY_UNSUPPORTED) return rc;
+  }
+  return copy_buffered(src_fd, dest_fd);
+}
+
+
+/**
+ * Recreates a symlink, FIFO or device node instead of copying through it.
+ * @return 0 on success, -1 on error
+ */
+static int copy_special(const char *src, const char *dest,
+                        const struct stat *st, int flags) {
+  for (int attempt = 0; attempt < 2; attempt++) {
+    int rc;
+    if (S_ISLNK(st->st_mode)) {
+      char target[PATH_MAX];
+      ssize_t len = readlink(src, target, sizeof(target) - 1);
+      if (len < 0) return -1;
+      target[len] = '\0';
+      rc = symlink(target, dest);
+    } else {
+      rc = mknod(dest, st->st_mode, st->st_rdev);
+    }
+    if (rc == 0) return 0;
+    if (errno != EEXIST || !(flags & JBOX_COPY_FORCE) || attempt > 0 ||
+        unlink(dest) != 0) {
+      return -1;
+    }
+  }
+  return -1;
+}
+
+
+/**
+ * Checks whether a destination already matches its source by size and
+ * mtime, as JBOX_COPY_UPDATE decides.
+ * @return Non-zero if dest is a regular file matching src
+ */
+static int is_unchanged(const char *src, const char *dest, int flags) {
+  struct stat src_st, dest_st;
+  int rc = (flags & JBOX_COPY_NOFOLLOW) ? lstat(src, &src_st)
+                                        : stat(src, &src_st);
+  return rc == 0 && lstat(dest, &dest_st) == 0
+         && S_ISREG(src_st.st_mode) && S_ISREG(dest_st.st_mode)
+         && src_st.st_size == dest_st.st_size
+         && src_st.st_mtim.tv_sec == dest_st.st_mtim.tv_sec
+         && src_st.st_mtim.tv_nsec == dest_st.st_mtim.tv_nsec;
+}
+
+
+/**
+ * Copies a file, or under JBOX_COPY_UPDATE leaves an unchanged one be.
+ * @param skipped Set to whether the file was left alone, or NULL
+ * @return 0 on success, -1 on error (errno set), -2 on interrupt
+ */
+static int copy_file(const char *src, const char *dest, int flags,
+                     int *skipped) {
+  if (skipped) *skipped = 0;
+  if (flags & JBOX_COPY_UPDATE) {
+    if (is_unchanged(src, dest, flags)) {
+      if (skipped) *skipped = 1;
+      return 0;
+    }
+    flags |= JBOX_COPY_FORCE;
+  }
+
+  if (flags & JBOX_COPY_NOFOLLOW) {
+    struct stat st;
+    if (lstat(src, &st) != 0) return -1;
+    if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)) {
+      return copy_special(src, dest, &st, flags);
+    }
+  }
+
+  int src_fd = open(src, O_RDONLY | O_CLOEXEC);
+  if (src_fd < 0) return -1;
+
+  struct stat src_stat;
+  if (fstat(src_fd, &src_stat) != 0) {
+    int saved_errno = errno;
+    close(src_fd);
+    errno = saved_errno;
+    return -1;
+  }
+
+  /* O_EXCL refuses an existing destination without a separate check */
+  int open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+  if (!(flags & JBOX_COPY_FORCE)) open_flags |= O_EXCL;
+  int dest_fd = open(dest, open_flags, src_stat.st_mode & 0777);
+  if (dest_fd < 0) {
+    int saved_errno = errno;
+    close(src_fd);
+    errno = saved_errno;
+    return -1;
+  }
+
+  int result = jbox_copy_data(src_fd, dest_fd, &src_stat);
+  int saved_errno = errno;
+
+  fchmod(dest_fd, src_stat.st_mode & 0777);
+  if (result == 0 && (flags & JBOX_COPY_UPDATE)) {
+    struct timespec times[2] = {
+      { .tv_nsec = UTIME_OMIT },
+      src_stat.st_mtim
+    };
+    if (futimens(dest_fd, times) != 0) {
+      result = -1;
+      saved_errno = errno;
+    }
+  }
+  if (result == 0 && (flags & JBOX_COPY_SYNC) && fsync(dest_fd) != 0) {
+    result = -1;
+    saved_errno = errno;
+  }
+  if (close(dest_fd) != 0 && result == 0) {
+    result = -1;
+    saved_errno = errno;
+  }
+  close(src_fd);
+
+  errno = saved_errno;
+  return result;
+}
+
+
+int jbox_copy_file(const char *src, const char *dest, int flags) {
+  return copy_file(src, dest, flags, NULL);
+}
+
+
+/** State shared by the walker threads copying one tree */
+typedef struct {
+  const char *dest;
+  int flags;
+  int failed;           /* A copy failed; first_errno says why */
+  int first_errno;
+  pthread_mutex_t lock;
+  atomic_size_t copied;
+  atomic_size_t skipped;
+  atomic_size_t deleted;
+} copy_tree_t;
+
+
+/**
+ * Records a failure; only the first one's errno is kept.
+ */
+static void note_error(copy_tree_t *tree, int err) {
+  pthread_mutex_lock(&tree->lock);
+  if (!tree->failed) {
+    tree->failed = 1;
+    tree->first_errno = err;
+  }
+  pthread_mutex_unlock(&tree->lock);
+}
+
+
+/**
+ * Removes the entries of an existing destination directory that its
+ * source directory lacks, or has as a directory where the destination
+ * has none or the other way round.
+ * @param tree Tree being copied
+ * @param entry Source directory, as the walker found it
+ * @param dest Its destination
+ * @return 0, or -2 on interrupt
+ */
+static int prune_extraneous(copy_tree_t *tree, jbox_walk_entry_t *entry,
+                            const char *dest) {
+  int src_fd = openat(entry->dir_fd, entry->name,
+                      O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (src_fd < 0) {
+    note_error(tree, errno);
+    return 0;
+  }
+  DIR *dir = opendir(dest);
+  if (!dir) {
+    note_error(tree, errno);
+    close(src_fd);
+    return 0;
+  }
+
+  int follow = (tree->flags & JBOX_COPY_NOFOLLOW) ? AT_SYMLINK_NOFOLLOW : 0;
+  int rc = 0;
+  struct dirent *d;
+  while (rc == 0 && (d = readdir(dir)) != NULL) {
+    const char *name = d->d_name;
+    if (name[0] == '.' &&
+        (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+      continue;
+    }
+    struct stat src_st, dest_st;
+    if (fstatat(src_fd, name, &src_st, follow) == 0) {
+      if (fstatat(dirfd(dir), name, &dest_st, AT_SYMLINK_NOFOLLOW) != 0 ||
+          S_ISDIR(src_st.st_mode) == S_ISDIR(dest_st.st_mode)) {
+        continue;
+      }
+    } else if (errno != ENOENT) {
+      continue;
+    }
+
+    size_t len = strlen(dest) + strlen(name) + 2;
+    char *path = malloc(len);
+    if (!path) {
+      note_error(tree, ENOMEM);
+      break;
+    }
+    snprintf(path, len, "%s/%s", dest, name);
+    rc = jbox_remove_tree(path);
+    if (rc == 0) {
+      atomic_fetch_add(&tree->deleted, 1);
+    } else if (rc == -1) {
+      note_error(tree, errno);
+      rc = 0;
+    }
+    free(path);
+  }
+
+  closedir(dir);
+  close(src_fd);
+  return rc;
+}
+
+
+/**
+ * Copies one entry of a tree: creates directories before the walker
+ * descends into them and copies everything else in place.
+ * @param entry Entry found
+ * @param arg The copy_tree_t
+ * @return JBOX_WALK_CONTINUE, JBOX_WALK_SKIP for a directory that could
+ *         not be created, or JBOX_WALK_STOP on interrupt
+ */
+static int copy_visit(jbox_walk_entry_t *entry, void *arg) {
+  copy_tree_t *tree = arg;
+
+  size_t dest_len = strlen(tree->dest) + strlen(entry->rel) + 2;
+  char *dest = malloc(dest_len);
+  if (!dest) {
+    note_error(tree, ENOMEM);
+    return JBOX_WALK_STOP;
+  }
+  if (entry->rel[0] == '\0') {
+    snprintf(dest, dest_len, "%s", tree->dest);
+  } else {
+    snprintf(dest, dest_len, "%s/%s", tree->dest, entry->rel);
+  }
+
+  int action = JBOX_WALK_CONTINUE;
+  if (entry->type == DT_DIR) {
+    struct stat st;
+    if (fstatat(entry->dir_fd, entry->name, &st, 0) != 0) {
+      note_error(tree, errno);
+      action = JBOX_WALK_SKIP;
+    } else if (mkdir(dest, st.st_mode & 0777) == 0) {
+      /* New, so nothing in it to prune */
+    } else if (errno != EEXIST) {
+      note_error(tree, errno);
+      action = JBOX_WALK_SKIP;
+    } else if ((tree->flags & JBOX_COPY_DELETE) &&
+               prune_extraneous(tree, entry, dest) == -2) {
+      action = JBOX_WALK_STOP;
+    }
+  } else {
+    int skipped;
+    int rc = copy_file(entry->path, dest, tree->flags, &skipped);
+    if (rc == -2) {
+      action = JBOX_WALK_STOP;
+    } else if (rc != 0) {
+      note_error(tree, errno);
+    } else {
+      atomic_fetch_add(skipped ? &tree->skipped : &tree->copied, 1);
+    }
+  }
+
+  free(dest);
+  return action;
+}
+
+
+/**
+ * Records a directory that could not be read.
+ */
+static void copy_walk_error(const char *path, int err, void *arg) {
+  (void)path;
+  note_error(arg, err);
+}
+
+
+/**
+ * Flushes everything written under dest, directory entries included, by
+ * syncing its whole filesystem once rather than each file.
+ */
+static int sync_tree(const char *dest) {
+  int fd = open(dest, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) return -1;
+  int rc = syncfs(fd);
+  int saved_errno = errno;
+  close(fd);
+  errno = saved_errno;
+  return rc;
+}
+
+
+int jbox_copy_tree(const char *src, const char *dest, int flags,
+                   jbox_copy_stats_t *stats) {
+  /* Files are synced all at once at the end, not one by one */
+  copy_tree_t tree = { .dest = dest, .flags = flags & ~JBOX_COPY_SYNC };
+  pthread_mutex_init(&tree.lock, NULL);
+  atomic_init(&tree.copied, 0);
+  atomic_init(&tree.skipped, 0);
+  atomic_init(&tree.deleted, 0);
+
+  jbox_walk_options_t opts = {
+    .flags = (flags & JBOX_COPY_NOFOLLOW) ? 0 : JBOX_WALK_FOLLOW,
+    .max_depth = -1,
+    .visit = copy_visit,
+    .error = copy_walk_error,
+    .arg = &tree,
+  };
+  int result = jbox_walk(src, &opts);
+  int saved_errno = errno;
+  pthread_mutex_destroy(&tree.lock);
+  if (stats) {
+    stats->copied = atomic_load(&tree.copied);
+    stats->skipped = atomic_load(&tree.skipped);
+    stats->deleted = atomic_load(&tree.deleted);
+  }
+
+  if (result == 0 && tree.failed) {
+    result = -1;
+    saved_errno = tree.first_errno;
+  }
+  if (result == 0 && (flags & JBOX_COPY_SYNC) && sync_tree(dest) != 0) {
+    return -1;
+  }
+  errno = saved_errno;
+  return result;
+}
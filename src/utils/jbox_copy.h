@@ -0,0 +1,80 @@
+#ifndef JBOX_COPY_H
+#define JBOX_COPY_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+/** Overwrite existing destination files instead of failing with EEXIST. */
+#define JBOX_COPY_FORCE    0x1
+/** Recreate symlinks, FIFOs and device nodes rather than copying through
+ *  them, as a move must. */
+#define JBOX_COPY_NOFOLLOW 0x2
+/** Flush the copy to disk before returning. */
+#define JBOX_COPY_SYNC     0x4
+/** Leave a destination file alone when its size and mtime match the
+ *  source's, overwrite it otherwise, and give each file copied the
+ *  source's mtime so the next run can tell it is unchanged. */
+#define JBOX_COPY_UPDATE   0x8
+/** With jbox_copy_tree(), remove destination entries that the source
+ *  does not have, or has with a different type (directory or not). */
+#define JBOX_COPY_DELETE   0x10
+
+
+/** What a tree copy did */
+typedef struct {
+  size_t copied;            /**< Files copied */
+  size_t skipped;           /**< Files left alone as unchanged */
+  size_t deleted;           /**< Extraneous entries removed, each counted
+                                 once however much lay below it */
+} jbox_copy_stats_t;
+
+
+/**
+ * Copy everything from one open file to another, empty one.
+ *
+ * The fastest method the filesystems allow is used: a reflink (FICLONE)
+ * sharing the source's blocks, then copy_file_range() and sendfile()
+ * copying inside the kernel, and last a read/write loop through a large
+ * aligned buffer. Holes in a sparse source stay holes in the copy; other
+ * files are preallocated to their full size before any data is written.
+ *
+ * @param src_fd Source, read from its current offset
+ * @param dest_fd Destination
+ * @param st fstat() of the source; a size of 0 (as /proc reports) means
+ *        unknown, which skips straight to the buffer loop
+ * @return 0 on success, -1 on error (errno set), -2 on interrupt
+ */
+int jbox_copy_data(int src_fd, int dest_fd, const struct stat *st);
+
+/**
+ * Copy a file to a new path, keeping its permission bits.
+ *
+ * @param src Source path
+ * @param dest Destination path
+ * @param flags JBOX_COPY_* flags
+ * @return 0 on success, -1 on error (errno set), -2 on interrupt
+ */
+int jbox_copy_file(const char *src, const char *dest, int flags);
+
+/**
+ * Copy a directory tree.
+ *
+ * The tree is walked with jbox_walk() on one thread per core; each
+ * thread creates the directories and copies the files it comes across.
+ * A failed file does not stop the rest of the tree from being copied.
+ *
+ * With JBOX_COPY_DELETE, each destination directory is pruned by the
+ * thread that reaches it in the source, before anything is copied into
+ * it, so mirroring a tree costs one walk of it.
+ *
+ * @param src Source directory, or a file to copy alone
+ * @param dest Destination directory, created if missing
+ * @param flags JBOX_COPY_* flags
+ * @param stats Set to what was done, or NULL
+ * @return 0 on success, -1 on error (errno set to the first failure's),
+ *         -2 on interrupt
+ */
+int jbox_copy_tree(const char *src, const char *dest, int flags,
+                   jbox_copy_stats_t *stats);
+
+#endif /* JBOX_COPY_H */
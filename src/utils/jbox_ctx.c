@@ -0,0 +1,222 @@
+/**
+ * @file jbox_ctx.c
+ * @brief Per-invocation runtime context for jbox applications.
+ *
+ * Each thread running an app under a host installs a jbox_ctx_t; apps
+ * reach their streams, directory, interrupt flag, memory and exit path
+ * through the accessors here, so concurrent invocations stay isolated.
+ * Threads with no context installed use the process defaults.
+ */
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdlib.h>
+
+#include "jbox_ctx.h"
+#include "jbox_signals.h"
+
+
+/** Global flag indicating whether SIGINT was received. */
+volatile sig_atomic_t jbox_interrupted = 0;
+
+/** Context of a standalone app; NULL streams stand for stdin/stdout. */
+static jbox_ctx_t default_ctx = {
+  .interrupted = &jbox_interrupted,
+  .cwd_fd = AT_FDCWD,
+  .alloc = malloc,
+  .release = free
+};
+
+/** Context installed by jbox_ctx_run() on the calling thread. */
+static thread_local jbox_ctx_t *current_ctx = NULL;
+
+
+/**
+ * @brief Initializes a context from the process defaults.
+ *
+ * @param ctx Context to fill in.
+ */
+void jbox_ctx_init(jbox_ctx_t *ctx) {
+  *ctx = default_ctx;
+  ctx->in = stdin;
+  ctx->out = stdout;
+}
+
+
+/**
+ * @brief Runs an app's entry point under a context.
+ *
+ * Contexts nest: the one installed before is put back on return.
+ *
+ * @param ctx Context for the invocation.
+ * @param run App entry point.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return Exit status of the app.
+ */
+int jbox_ctx_run(jbox_ctx_t *ctx, int (*run)(int argc, char **argv),
+                 int argc, char **argv) {
+  jbox_ctx_t *previous = current_ctx;
+  jmp_buf env;
+
+  ctx->exit_env = &env;
+  current_ctx = ctx;
+  if (setjmp(env) == 0) {
+    ctx->exit_status = run(argc, argv);
+  }
+  current_ctx = previous;
+  ctx->exit_env = NULL;
+
+  fflush(ctx->out);
+  return ctx->exit_status;
+}
+
+
+/**
+ * @brief Gets the context of the calling thread.
+ *
+ * @return The installed context, or the process default.
+ */
+jbox_ctx_t *jbox_ctx_current(void) {
+  return (current_ctx != NULL) ? current_ctx : &default_ctx;
+}
+
+
+/**
+ * @brief Installs a spawning thread's context on a worker thread.
+ *
+ * The process default is left uninstalled, so a standalone app's
+ * workers still count as not hosted.
+ *
+ * @param ctx Context of the thread that started the worker.
+ */
+void jbox_ctx_adopt(jbox_ctx_t *ctx) {
+  current_ctx = (ctx != &default_ctx) ? ctx : NULL;
+}
+
+
+/**
+ * @brief Tells whether the calling thread runs under a host's context.
+ *
+ * @return true inside jbox_ctx_run().
+ */
+bool jbox_ctx_is_hosted(void) {
+  return current_ctx != NULL;
+}
+
+
+/**
+ * @brief Gets the current standard input stream.
+ *
+ * @return Input stream of the current context.
+ */
+FILE *jbox_stdin(void) {
+  FILE *in = jbox_ctx_current()->in;
+  return (in != NULL) ? in : stdin;
+}
+
+
+/**
+ * @brief Gets the current standard output stream.
+ *
+ * @return Output stream of the current context.
+ */
+FILE *jbox_stdout(void) {
+  FILE *out = jbox_ctx_current()->out;
+  return (out != NULL) ? out : stdout;
+}
+
+
+/**
+ * @brief Gets the descriptor behind the current standard input.
+ *
+ * @return Input descriptor of the current context.
+ */
+int jbox_stdin_fd(void) {
+  return fileno(jbox_stdin());
+}
+
+
+/**
+ * @brief Gets the descriptor behind the current standard output.
+ *
+ * @return Output descriptor of the current context.
+ */
+int jbox_stdout_fd(void) {
+  return fileno(jbox_stdout());
+}
+
+
+/**
+ * @brief Tells whether standard output takes binary records.
+ *
+ * @return true if the host set records_out on the current context.
+ */
+bool jbox_stdout_takes_records(void) {
+  return jbox_ctx_current()->records_out;
+}
+
+
+/**
+ * @brief Gets the directory relative paths resolve against.
+ *
+ * @return Directory descriptor of the current context, or AT_FDCWD.
+ */
+int jbox_cwd_fd(void) {
+  return jbox_ctx_current()->cwd_fd;
+}
+
+
+/**
+ * @brief printf() to the current standard output.
+ *
+ * @param fmt Format string.
+ * @return Number of bytes written, or a negative value on error.
+ */
+int jbox_printf(const char *fmt, ...) {
+  va_list ap;
+
+  va_start(ap, fmt);
+  int written = vfprintf(jbox_stdout(), fmt, ap);
+  va_end(ap);
+  return written;
+}
+
+
+/**
+ * @brief Allocates scratch memory for the current invocation.
+ *
+ * @param size Number of bytes.
+ * @return The memory, or NULL if out of memory.
+ */
+void *jbox_alloc(size_t size) {
+  return jbox_ctx_current()->alloc(size);
+}
+
+
+/**
+ * @brief Releases memory from jbox_alloc().
+ *
+ * @param ptr Memory to release; NULL is ignored.
+ */
+void jbox_release(void *ptr) {
+  if (ptr != NULL) {
+    jbox_ctx_current()->release(ptr);
+  }
+}
+
+
+/**
+ * @brief Ends the current invocation.
+ *
+ * @param status Exit status.
+ */
+void jbox_exit(int status) {
+  jbox_ctx_t *ctx = jbox_ctx_current();
+
+  if (ctx->exit_env == NULL) {
+    exit(status);
+  }
+  ctx->exit_status = status;
+  longjmp(*ctx->exit_env, 1);
+}
@@ -0,0 +1,167 @@
+#ifndef JBOX_CTX_H
+#define JBOX_CTX_H
+
+#include <setjmp.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * Everything one invocation of an app may touch outside its own frame.
+ *
+ * Apps reach their standard streams, working directory, interrupt flag,
+ * scratch memory and exit path through the accessors below rather than
+ * through stdin, stdout, STDIN_FILENO/STDOUT_FILENO, the process working
+ * directory, a static flag, static buffers or exit(). A standalone app
+ * uses the process-wide defaults; a host such as jshell runs each
+ * invocation with jbox_ctx_run() and its own context, so several apps
+ * can run at once on different threads.
+ */
+typedef struct jbox_ctx {
+  FILE *in;                              /* Standard input */
+  FILE *out;                             /* Standard output */
+  volatile sig_atomic_t *interrupted;    /* Set when the app should stop */
+  const atomic_bool *cancelled;          /* Set by the host when the app
+                                            should stop for good (nobody
+                                            reads its output), or NULL */
+  bool records_out;                      /* The next pipeline stage reads
+                                            jbox_record.h records */
+  int cwd_fd;                            /* Directory relative paths
+                                            resolve against (AT_FDCWD for
+                                            the process's) */
+  void *(*alloc)(size_t size);           /* Scratch memory */
+  void (*release)(void *ptr);
+  jmp_buf *exit_env;                     /* Where jbox_exit() returns to */
+  int exit_status;
+} jbox_ctx_t;
+
+/**
+ * Initialize a context from the process defaults: stdin, stdout, the
+ * process interrupt flag (see jbox_signals.h), malloc() and free().
+ *
+ * @param ctx Context to fill in
+ */
+void jbox_ctx_init(jbox_ctx_t *ctx);
+
+/**
+ * Run an app's entry point under a context on the calling thread.
+ * The context stays installed until run returns or calls jbox_exit(),
+ * and its output stream is flushed afterwards. The caller keeps
+ * ownership of the streams.
+ *
+ * @param ctx Context for the invocation
+ * @param run App entry point
+ * @param argc Argument count
+ * @param argv Argument vector
+ * @return Exit status of the app
+ */
+int jbox_ctx_run(jbox_ctx_t *ctx, int (*run)(int argc, char **argv),
+                 int argc, char **argv);
+
+/**
+ * Get the context of the calling thread.
+ *
+ * @return The installed context, or the process default
+ */
+jbox_ctx_t *jbox_ctx_current(void);
+
+/**
+ * Install a context on a worker thread an app started, so the worker
+ * shares the invocation's streams, interrupt flag and memory. Workers
+ * must not call jbox_exit().
+ *
+ * @param ctx Context of the thread that started the worker, from
+ *        jbox_ctx_current()
+ */
+void jbox_ctx_adopt(jbox_ctx_t *ctx);
+
+/**
+ * Tell whether the calling thread runs under a host's context, which
+ * owns the streams: apps must then leave their buffering alone.
+ *
+ * @return true inside jbox_ctx_run(), false for a standalone app
+ */
+bool jbox_ctx_is_hosted(void);
+
+/**
+ * Get the current standard input stream.
+ *
+ * @return Input stream of the current context
+ */
+FILE *jbox_stdin(void);
+
+/**
+ * Get the current standard output stream.
+ *
+ * @return Output stream of the current context
+ */
+FILE *jbox_stdout(void);
+
+/**
+ * Get the descriptor behind the current standard input, for raw reads.
+ *
+ * @return Input descriptor of the current context
+ */
+int jbox_stdin_fd(void);
+
+/**
+ * Get the descriptor behind the current standard output, for raw
+ * writes. Flush jbox_stdout() before writing to it directly.
+ *
+ * @return Output descriptor of the current context
+ */
+int jbox_stdout_fd(void);
+
+/**
+ * Tell whether structured output may go to standard output as binary
+ * records (see jbox_record.h) rather than JSON text: set by the host
+ * when the stage reading it takes records.
+ *
+ * @return true if the current context's output reads records
+ */
+bool jbox_stdout_takes_records(void);
+
+/**
+ * Get the directory relative paths resolve against, for openat(),
+ * fstatat() and statx(). A host running several invocations at once
+ * gives each its own, so none depends on the process working directory.
+ *
+ * @return Directory descriptor of the current context, or AT_FDCWD
+ */
+int jbox_cwd_fd(void);
+
+/**
+ * printf() to the current standard output.
+ *
+ * @param fmt Format string
+ * @return Number of bytes written, or a negative value on error
+ */
+int jbox_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/**
+ * Allocate scratch memory for the current invocation.
+ *
+ * @param size Number of bytes
+ * @return The memory, or NULL if out of memory
+ */
+void *jbox_alloc(size_t size);
+
+/**
+ * Release memory from jbox_alloc().
+ *
+ * @param ptr Memory to release; NULL is ignored
+ */
+void jbox_release(void *ptr);
+
+/**
+ * End the current invocation. Under a host this returns from
+ * jbox_ctx_run() with the status, without releasing what the app
+ * holds; a standalone app exits the process.
+ *
+ * @param status Exit status
+ */
+void jbox_exit(int status) __attribute__((noreturn));
+
+#endif /* JBOX_CTX_H */
@@ -0,0 +1,342 @@
+/**
+ * @file jbox_dircache.c
+ * @brief Cache of open directory descriptors for jbox applications.
+ *
+ * Every directory the cache has opened is a node under one of two roots,
+ * "/" and the working directory. Children are found through one hash
+ * table keyed by (parent, name), so the trie costs a hash lookup per
+ * path component however wide a directory is. Open nodes sit on an LRU
+ * list; once more than JBOX_DIRCACHE_MAX_OPEN are open the coldest is
+ * closed, keeping its node, and reopened relative to its nearest open
+ * ancestor when a path needs it again.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "jbox_dircache.h"
+
+
+/** Directory descriptors kept open at once */
+#define JBOX_DIRCACHE_MAX_OPEN 256
+
+/** Initial number of hash slots; always a power of two */
+#define JBOX_DIRCACHE_INITIAL_SLOTS 256
+
+
+/** One cached directory */
+typedef struct dircache_node {
+  struct dircache_node *parent;   /* NULL for the two roots */
+  struct dircache_node *lru_prev; /* Towards the most recently used */
+  struct dircache_node *lru_next;
+  int fd;                         /* -1 while closed */
+  uint64_t hash;
+  size_t name_len;
+  char name[];
+} dircache_node_t;
+
+struct jbox_dircache {
+  dircache_node_t cwd;            /* fd is AT_FDCWD, never closed */
+  dircache_node_t root;           /* "/", opened on first use */
+  dircache_node_t **slots;        /* Open addressing, linear probing */
+  size_t nslots;
+  size_t nnodes;
+  dircache_node_t *lru_head;      /* Most recently used open node */
+  dircache_node_t *lru_tail;
+  size_t nopen;
+};
+
+
+/**
+ * Hashes a name under a parent node (FNV-1a, seeded by the parent).
+ */
+static uint64_t hash_name(const dircache_node_t *parent, const char *name,
+                          size_t len) {
+  uint64_t h = 1469598103934665603ULL ^ (uint64_t)(uintptr_t)parent;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)name[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+
+/**
+ * Removes an open node from the LRU list.
+ */
+static void lru_unlink(jbox_dircache_t *cache, dircache_node_t *node) {
+  if (node->lru_prev) node->lru_prev->lru_next = node->lru_next;
+  else cache->lru_head = node->lru_next;
+  if (node->lru_next) node->lru_next->lru_prev = node->lru_prev;
+  else cache->lru_tail = node->lru_prev;
+  node->lru_prev = node->lru_next = NULL;
+}
+
+
+/**
+ * Puts an open node at the front of the LRU list.
+ */
+static void lru_push(jbox_dircache_t *cache, dircache_node_t *node) {
+  node->lru_prev = NULL;
+  node->lru_next = cache->lru_head;
+  if (cache->lru_head) cache->lru_head->lru_prev = node;
+  cache->lru_head = node;
+  if (!cache->lru_tail) cache->lru_tail = node;
+}
+
+
+/**
+ * Marks a node as just used. The roots are not on the list.
+ */
+static void lru_touch(jbox_dircache_t *cache, dircache_node_t *node) {
+  if (!node->parent || cache->lru_head == node) return;
+  lru_unlink(cache, node);
+  lru_push(cache, node);
+}
+
+
+/**
+ * Records a newly opened node and closes the coldest one if too many are
+ * open. The new node and, having been used just before it, its parent
+ * are at the front of the list and never the ones closed.
+ */
+static void lru_add(jbox_dircache_t *cache, dircache_node_t *node) {
+  lru_push(cache, node);
+  if (++cache->nopen <= JBOX_DIRCACHE_MAX_OPEN) return;
+
+  dircache_node_t *cold = cache->lru_tail;
+  lru_unlink(cache, cold);
+  close(cold->fd);
+  cold->fd = -1;
+  cache->nopen--;
+}
+
+
+/**
+ * Returns an open descriptor for a node, reopening it if it was closed.
+ *
+ * A closed node is reopened with one openat() of its path relative to
+ * the nearest open ancestor; the directories in between stay closed, so
+ * input that keeps missing the cache costs one extra call per path
+ * rather than one per evicted level.
+ *
+ * @return The descriptor, or -1 on error (errno set)
+ */
+static int node_fd(jbox_dircache_t *cache, dircache_node_t *node) {
+  if (node == &cache->root && node->fd < 0) {
+    node->fd = open("/", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    return node->fd;
+  }
+  if (node->fd >= 0 || node == &cache->cwd) {
+    lru_touch(cache, node);
+    return node->fd;
+  }
+
+  char rel[PATH_MAX];
+  size_t pos = sizeof(rel) - 1;
+  rel[pos] = '\0';
+  dircache_node_t *base = node;
+  do {
+    if (base->name_len + 1 > pos) {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+    if (base != node) rel[--pos] = '/';
+    pos -= base->name_len;
+    memcpy(rel + pos, base->name, base->name_len);
+    base = base->parent;
+  } while (base->parent && base->fd < 0);
+
+  int base_fd = node_fd(cache, base);
+  if (base_fd == -1) return -1;
+  int fd = openat(base_fd, rel + pos, O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) return -1;
+  node->fd = fd;
+  lru_add(cache, node);
+  return fd;
+}
+
+
+/**
+ * Doubles the hash table. Failing only means longer probes, so callers
+ * carry on unless the table is nearly full.
+ * @return 0 on success, -1 if out of memory
+ */
+static int grow_slots(jbox_dircache_t *cache) {
+  size_t nslots = cache->nslots * 2;
+  dircache_node_t **slots = calloc(nslots, sizeof(*slots));
+  if (!slots) return -1;
+
+  for (size_t i = 0; i < cache->nslots; i++) {
+    dircache_node_t *node = cache->slots[i];
+    if (!node) continue;
+    size_t j = node->hash & (nslots - 1);
+    while (slots[j]) j = (j + 1) & (nslots - 1);
+    slots[j] = node;
+  }
+  free(cache->slots);
+  cache->slots = slots;
+  cache->nslots = nslots;
+  return 0;
+}
+
+
+/**
+ * Finds or opens a child directory of a node.
+ *
+ * @param cache Cache
+ * @param parent Parent node
+ * @param name Component, not NUL-terminated
+ * @param len Length of name
+ * @param create Make the directory if it does not exist
+ * @param mode Mode for a made directory
+ * @return The child, or NULL on error (errno set)
+ */
+static dircache_node_t *child_node(jbox_dircache_t *cache,
+                                   dircache_node_t *parent, const char *name,
+                                   size_t len, int create, mode_t mode) {
+  if ((cache->nnodes + 1) * 2 > cache->nslots && grow_slots(cache) != 0 &&
+      (cache->nnodes + 1) * 4 > cache->nslots * 3) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  uint64_t hash = hash_name(parent, name, len);
+  size_t mask = cache->nslots - 1;
+  size_t i = hash & mask;
+  for (dircache_node_t *node; (node = cache->slots[i]) != NULL;
+       i = (i + 1) & mask) {
+    if (node->hash == hash && node->parent == parent &&
+        node->name_len == len && memcmp(node->name, name, len) == 0) {
+      return node;
+    }
+  }
+
+  if (len > NAME_MAX) {
+    errno = ENAMETOOLONG;
+    return NULL;
+  }
+  dircache_node_t *node = malloc(sizeof(*node) + len + 1);
+  if (!node) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  memcpy(node->name, name, len);
+  node->name[len] = '\0';
+
+  int parent_fd = node_fd(cache, parent);
+  if (parent_fd == -1) {
+    free(node);
+    return NULL;
+  }
+  int flags = O_PATH | O_DIRECTORY | O_CLOEXEC;
+  int fd = openat(parent_fd, node->name, flags);
+  if (fd < 0 && errno == ENOENT && create) {
+    if (mkdirat(parent_fd, node->name, mode) != 0 && errno != EEXIST) {
+      free(node);
+      return NULL;
+    }
+    fd = openat(parent_fd, node->name, flags);
+  }
+  if (fd < 0) {
+    free(node);
+    return NULL;
+  }
+
+  node->parent = parent;
+  node->lru_prev = node->lru_next = NULL;
+  node->fd = fd;
+  node->hash = hash;
+  node->name_len = len;
+  cache->slots[i] = node;
+  cache->nnodes++;
+  lru_add(cache, node);
+  return node;
+}
+
+
+/**
+ * Walks the directories in path[0, len) from the matching root.
+ * @return The last directory's node, or NULL on error (errno set)
+ */
+static dircache_node_t *walk(jbox_dircache_t *cache, const char *path,
+                             size_t len, int create, mode_t mode) {
+  dircache_node_t *node = path[0] == '/' ? &cache->root : &cache->cwd;
+  size_t i = 0;
+
+  while (i < len) {
+    while (i < len && path[i] == '/') i++;
+    size_t start = i;
+    while (i < len && path[i] != '/') i++;
+    size_t n = i - start;
+    if (n == 0 || (n == 1 && path[start] == '.')) continue;
+
+    node = child_node(cache, node, path + start, n, create, mode);
+    if (!node) return NULL;
+  }
+  return node;
+}
+
+
+jbox_dircache_t *jbox_dircache_new(void) {
+  jbox_dircache_t *cache = calloc(1, sizeof(*cache));
+  if (!cache) return NULL;
+  cache->slots = calloc(JBOX_DIRCACHE_INITIAL_SLOTS, sizeof(*cache->slots));
+  if (!cache->slots) {
+    free(cache);
+    return NULL;
+  }
+  cache->nslots = JBOX_DIRCACHE_INITIAL_SLOTS;
+  cache->cwd.fd = AT_FDCWD;
+  cache->root.fd = -1;
+  return cache;
+}
+
+
+void jbox_dircache_free(jbox_dircache_t *cache) {
+  if (!cache) return;
+  for (size_t i = 0; i < cache->nslots; i++) {
+    dircache_node_t *node = cache->slots[i];
+    if (!node) continue;
+    if (node->fd >= 0) close(node->fd);
+    free(node);
+  }
+  if (cache->root.fd >= 0) close(cache->root.fd);
+  free(cache->slots);
+  free(cache);
+}
+
+
+int jbox_dircache_open(jbox_dircache_t *cache, const char *path, int create,
+                       mode_t mode) {
+  dircache_node_t *node = walk(cache, path, strlen(path), create, mode);
+  return node ? node_fd(cache, node) : -1;
+}
+
+
+int jbox_dircache_parent(jbox_dircache_t *cache, const char *path, int create,
+                         mode_t mode, const char **leaf) {
+  size_t end = strlen(path);
+  while (end > 1 && path[end - 1] == '/') end--;
+  size_t start = end;
+  while (start > 0 && path[start - 1] != '/') start--;
+
+  if (start == end) {
+    /* Only slashes: "/" names itself */
+    *leaf = path;
+    return AT_FDCWD;
+  }
+  *leaf = path + start;
+  if (start == 0) return AT_FDCWD;
+
+  dircache_node_t *node = walk(cache, path, start, create, mode);
+  return node ? node_fd(cache, node) : -1;
+}
@@ -0,0 +1,65 @@
+#ifndef JBOX_DIRCACHE_H
+#define JBOX_DIRCACHE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/** Cache of open directories, private to jbox_dircache.c. */
+typedef struct jbox_dircache jbox_dircache_t;
+
+
+/**
+ * Create an empty directory cache.
+ *
+ * The cache is a trie with one node per directory it has opened, each
+ * holding an O_PATH descriptor. Resolving a path whose leading
+ * directories are already cached costs no path walk at all, so tools
+ * handling many paths under the same few directories make one *at()
+ * call per path instead of resolving it from the root each time. Only
+ * a bounded number of descriptors stays open; older ones are closed and
+ * reopened from their parent when needed again.
+ *
+ * Cached directories are assumed not to be renamed or removed by
+ * anyone else while the cache is in use.
+ *
+ * @return The cache, or NULL if out of memory
+ */
+jbox_dircache_t *jbox_dircache_new(void);
+
+/**
+ * Close every cached descriptor and free the cache.
+ *
+ * @param cache Cache to free; NULL is ignored
+ */
+void jbox_dircache_free(jbox_dircache_t *cache);
+
+/**
+ * Get a descriptor for a directory.
+ *
+ * @param cache Cache to resolve through
+ * @param path Directory path, absolute or relative to the working
+ *        directory
+ * @param create Make missing directories along the way, like mkdir -p
+ * @param mode Mode for directories that are made
+ * @return A descriptor owned by the cache (AT_FDCWD for "."), valid
+ *         until the next call; -1 on error (errno set)
+ */
+int jbox_dircache_open(jbox_dircache_t *cache, const char *path, int create,
+                       mode_t mode);
+
+/**
+ * Get a descriptor for the directory holding a path's last component.
+ *
+ * @param cache Cache to resolve through
+ * @param path Path to split
+ * @param create Make missing parent directories, like mkdir -p
+ * @param mode Mode for directories that are made
+ * @param leaf Set to the last component within path, trailing slashes
+ *        included, for use with the returned descriptor in *at() calls
+ * @return A descriptor owned by the cache, valid until the next call;
+ *         -1 on error (errno set)
+ */
+int jbox_dircache_parent(jbox_dircache_t *cache, const char *path, int create,
+                         mode_t mode, const char **leaf);
+
+#endif /* JBOX_DIRCACHE_H */
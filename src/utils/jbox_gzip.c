@@ -0,0 +1,596 @@
+/**
+ * @file jbox_gzip.c
+ * @brief Independent gzip members and a parallel gzip writer.
+ *
+ * A member is written as raw deflate data between a header and trailer
+ * built here rather than by zlib, so the header can carry the member's
+ * size: FEXTRA with one subfield, "JB", of four bytes holding the size of
+ * the whole member (header and trailer included) little-endian. RFC 1952
+ * readers skip subfields they do not know.
+ *
+ * The writer keeps a ring of 2 * threads + 1 slots, each with an input
+ * block and an output buffer. Writes fill the slot after the last one
+ * handed out; a full slot goes to the threads, which take slots in
+ * order. Before a slot is filled again, the member compressed from it
+ * earlier is written out, so the descriptor sees members in input order
+ * and memory stays at a few blocks per thread.
+ *
+ * A zlib writer fills the same ring, but a slot also gets a copy of the
+ * end of the block before, taken as it starts to fill, while that block
+ * is still intact. Its output is the zlib header, the blocks, an empty
+ * final block and the combined Adler-32. With one thread it keeps a
+ * z_stream of its own instead, and no ring.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "jbox_gzip.h"
+
+
+struct jbox_gzip_deflater {
+  z_stream z;
+  int level;
+  bool ready;               /* deflateInit2() was called */
+};
+
+/** Output buffer of a writer deflating on its own thread */
+#define GZIP_STREAM_BUFFER (64 * 1024)
+
+/** One block of the writer's ring */
+typedef struct {
+  unsigned char *in;
+  size_t in_len;
+  unsigned char *dict;      /* End of the block before, for zlib */
+  size_t dict_len;
+  uint32_t adler;           /* Adler-32 of in, for zlib */
+  unsigned char *out;
+  size_t out_len;
+  size_t out_cap;
+  bool done;
+  bool failed;
+} gzip_slot_t;
+
+struct jbox_gzip_writer {
+  int fd;
+  int level;
+  jbox_gzip_sink_fn sink;
+  void *sink_ctx;
+  bool zlib;                /* One zlib stream rather than members */
+  bool header_sent;         /* The zlib header was handed to the sink */
+  uint32_t adler;           /* Adler-32 of the blocks handed on */
+  z_stream *z;              /* Deflating on the writer's own thread */
+  unsigned char *z_out;     /* Output buffer of z */
+  gzip_slot_t *slots;
+  size_t count;
+  size_t filled;            /* Blocks handed to the threads */
+  size_t taken;             /* Blocks taken by a thread */
+  size_t written;           /* Members written to fd */
+  bool closed;
+  int error;                /* errno of the first failure, or 0 */
+  pthread_mutex_t lock;
+  pthread_cond_t work;      /* A block was handed out, or the ring closed */
+  pthread_cond_t done;      /* A member was finished */
+  pthread_t threads[JBOX_GZIP_MAX_WORKERS];
+  int started;
+};
+
+
+static void put_le32(unsigned char *p, uint32_t v) {
+  p[0] = (unsigned char)v;
+  p[1] = (unsigned char)(v >> 8);
+  p[2] = (unsigned char)(v >> 16);
+  p[3] = (unsigned char)(v >> 24);
+}
+
+
+// ---------------------------------------------------------------------------
+// Members
+// ---------------------------------------------------------------------------
+
+jbox_gzip_deflater_t *jbox_gzip_deflater_new(int level) {
+  jbox_gzip_deflater_t *d = calloc(1, sizeof(*d));
+  if (d) d->level = level;
+  return d;
+}
+
+
+int jbox_gzip_member(jbox_gzip_deflater_t *d, const void *data, size_t len,
+                     unsigned char **out, size_t *cap, size_t *out_len) {
+  if (!d->ready) {
+    if (deflateInit2(&d->z, d->level, Z_DEFLATED, -MAX_WBITS, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+      errno = ENOMEM;
+      return -1;
+    }
+    d->ready = true;
+  } else {
+    deflateReset(&d->z);
+  }
+
+  size_t bound = JBOX_GZIP_HEADER_LEN + deflateBound(&d->z, len) + 8;
+  if (bound > *cap) {
+    unsigned char *grown = realloc(*out, bound);
+    if (!grown) return -1;
+    *out = grown;
+    *cap = bound;
+  }
+
+  d->z.next_in = (Bytef *)data;
+  d->z.avail_in = (uInt)len;
+  d->z.next_out = *out + JBOX_GZIP_HEADER_LEN;
+  d->z.avail_out = (uInt)(bound - JBOX_GZIP_HEADER_LEN - 8);
+  if (deflate(&d->z, Z_FINISH) != Z_STREAM_END) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  size_t size = JBOX_GZIP_HEADER_LEN + d->z.total_out + 8;
+  static const unsigned char header[16] = {
+    0x1f, 0x8b, 8, 4,       /* Magic, deflate, FEXTRA */
+    0, 0, 0, 0, 0, 3,       /* No mtime, no extra flags, Unix */
+    8, 0,                   /* Extra field length */
+    'J', 'B', 4, 0          /* Subfield id and length */
+  };
+  unsigned char *p = *out;
+  memcpy(p, header, sizeof(header));
+  put_le32(p + 16, (uint32_t)size);
+  put_le32(p + size - 8, (uint32_t)crc32(0, data, (uInt)len));
+  put_le32(p + size - 4, (uint32_t)len);
+  *out_len = size;
+  return 0;
+}
+
+
+/**
+ * Compress a block of a zlib stream into raw deflate data ending on a
+ * byte boundary, primed with the block's dictionary.
+ * @return 0 on success, -1 if out of memory
+ */
+static int zlib_block(jbox_gzip_deflater_t *d, gzip_slot_t *slot) {
+  if (!d->ready) {
+    if (deflateInit2(&d->z, d->level, Z_DEFLATED, -MAX_WBITS, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+      errno = ENOMEM;
+      return -1;
+    }
+    d->ready = true;
+  } else {
+    deflateReset(&d->z);
+  }
+  if (slot->dict_len > 0 &&
+      deflateSetDictionary(&d->z, slot->dict, (uInt)slot->dict_len) != Z_OK) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  /* A sync flush adds a few bytes to the bound; grow if ever short */
+  size_t bound = deflateBound(&d->z, slot->in_len) + 16;
+  if (bound > slot->out_cap) {
+    unsigned char *grown = realloc(slot->out, bound);
+    if (!grown) return -1;
+    slot->out = grown;
+    slot->out_cap = bound;
+  }
+  d->z.next_in = slot->in;
+  d->z.avail_in = (uInt)slot->in_len;
+  d->z.next_out = slot->out;
+  d->z.avail_out = (uInt)slot->out_cap;
+  for (;;) {
+    int rc = deflate(&d->z, Z_SYNC_FLUSH);
+    if (rc != Z_OK && rc != Z_BUF_ERROR) {
+      errno = ENOMEM;
+      return -1;
+    }
+    if (d->z.avail_out > 0) break;
+    unsigned char *grown = realloc(slot->out, slot->out_cap * 2);
+    if (!grown) return -1;
+    slot->out = grown;
+    d->z.next_out = grown + slot->out_cap;
+    d->z.avail_out = (uInt)slot->out_cap;
+    slot->out_cap *= 2;
+  }
+  slot->out_len = slot->out_cap - d->z.avail_out;
+  slot->adler = (uint32_t)adler32(adler32(0, Z_NULL, 0), slot->in,
+                                  (uInt)slot->in_len);
+  return 0;
+}
+
+
+void jbox_gzip_deflater_free(jbox_gzip_deflater_t *d) {
+  if (!d) return;
+  if (d->ready) deflateEnd(&d->z);
+  free(d);
+}
+
+
+size_t jbox_gzip_member_size(const unsigned char *p) {
+  if (p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 || p[3] != 4 ||
+      p[10] != 8 || p[11] != 0 || p[12] != 'J' || p[13] != 'B' ||
+      p[14] != 4 || p[15] != 0) {
+    return 0;
+  }
+  size_t size = (size_t)p[16] | (size_t)p[17] << 8 | (size_t)p[18] << 16 |
+                (size_t)p[19] << 24;
+  return size >= JBOX_GZIP_HEADER_LEN + 8 ? size : 0;
+}
+
+
+// ---------------------------------------------------------------------------
+// Writer
+// ---------------------------------------------------------------------------
+
+static void *gzip_worker(void *arg) {
+  jbox_gzip_writer_t *w = arg;
+  jbox_gzip_deflater_t *d = jbox_gzip_deflater_new(w->level);
+
+  pthread_mutex_lock(&w->lock);
+  for (;;) {
+    while (!w->closed && w->taken == w->filled) {
+      pthread_cond_wait(&w->work, &w->lock);
+    }
+    if (w->taken == w->filled) break;
+    gzip_slot_t *slot = &w->slots[w->taken++ % w->count];
+    pthread_mutex_unlock(&w->lock);
+
+    int rc = !d ? -1
+             : w->zlib ? zlib_block(d, slot)
+             : jbox_gzip_member(d, slot->in, slot->in_len, &slot->out,
+                                &slot->out_cap, &slot->out_len);
+
+    pthread_mutex_lock(&w->lock);
+    slot->failed = rc != 0;
+    slot->done = true;
+    pthread_cond_broadcast(&w->done);
+  }
+  pthread_mutex_unlock(&w->lock);
+
+  jbox_gzip_deflater_free(d);
+  return NULL;
+}
+
+
+/** Sink of a writer to a descriptor: write all of it. */
+static int fd_sink(void *ctx, const void *data, size_t len) {
+  jbox_gzip_writer_t *w = ctx;
+  const unsigned char *p = data;
+  while (len > 0) {
+    ssize_t n = write(w->fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+
+/**
+ * Hand output to the sink.
+ * @return 0 on success, -1 on error (w->error set).
+ */
+static int emit(jbox_gzip_writer_t *w, const void *data, size_t len) {
+  if (len == 0) return 0;
+  if (w->sink(w->sink_ctx, data, len) < 0) {
+    w->error = errno ? errno : EIO;
+    return -1;
+  }
+  return 0;
+}
+
+
+/**
+ * Start a zlib stream from the ring with its header, once.
+ * @return 0 on success, -1 on error (w->error set).
+ */
+static int emit_header(jbox_gzip_writer_t *w) {
+  static const unsigned char header[2] = { 0x78, 0x9c };
+  if (w->header_sent) return 0;
+  w->header_sent = true;
+  return emit(w, header, sizeof(header));
+}
+
+
+/**
+ * Deflate on the writer's own thread, handing what comes out to the sink.
+ * @param flush Z_NO_FLUSH, or Z_FINISH to end the stream
+ * @return 0 on success, -1 on error (w->error set).
+ */
+static int stream_write(jbox_gzip_writer_t *w, const void *data, size_t len,
+                        int flush) {
+  const unsigned char *p = data;
+  do {
+    /* zlib takes at most a uInt at a time */
+    uInt n = len > UINT32_MAX ? UINT32_MAX : (uInt)len;
+    w->z->next_in = (Bytef *)p;
+    w->z->avail_in = n;
+    p += n;
+    len -= n;
+    int last = len == 0 ? flush : Z_NO_FLUSH;
+    do {
+      w->z->next_out = w->z_out;
+      w->z->avail_out = GZIP_STREAM_BUFFER;
+      if (deflate(w->z, last) == Z_STREAM_ERROR) {
+        w->error = EINVAL;
+        return -1;
+      }
+      if (emit(w, w->z_out, GZIP_STREAM_BUFFER - w->z->avail_out) < 0) {
+        return -1;
+      }
+    } while (w->z->avail_out == 0);
+  } while (len > 0);
+  return 0;
+}
+
+
+/**
+ * Wait for the oldest member in the ring and write it out.
+ * @return 0 on success, -1 on error (w->error set).
+ */
+static int write_oldest(jbox_gzip_writer_t *w) {
+  gzip_slot_t *slot = &w->slots[w->written % w->count];
+  pthread_mutex_lock(&w->lock);
+  while (!slot->done) pthread_cond_wait(&w->done, &w->lock);
+  pthread_mutex_unlock(&w->lock);
+
+  if (slot->failed) {
+    w->error = ENOMEM;
+    return -1;
+  }
+  if (w->zlib && emit_header(w) < 0) return -1;
+  if (emit(w, slot->out, slot->out_len) < 0) return -1;
+  if (w->zlib) {
+    w->adler = (uint32_t)adler32_combine(w->adler, slot->adler,
+                                         (z_off_t)slot->in_len);
+  }
+  slot->done = false;
+  slot->in_len = 0;
+  w->written++;
+  return 0;
+}
+
+
+/** Hand the block being filled to the threads. */
+static void submit(jbox_gzip_writer_t *w) {
+  pthread_mutex_lock(&w->lock);
+  w->filled++;
+  pthread_cond_signal(&w->work);
+  pthread_mutex_unlock(&w->lock);
+}
+
+
+/** Number of threads to start for a request of threads. */
+static int thread_count(int threads) {
+  if (threads <= 0) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = cores > 0 ? (int)cores : 1;
+  }
+  return threads > JBOX_GZIP_MAX_WORKERS ? JBOX_GZIP_MAX_WORKERS : threads;
+}
+
+
+/** Free a ring of slots, as far as it was allocated. */
+static void free_slots(gzip_slot_t *slots, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    free(slots[i].in);
+    free(slots[i].dict);
+    free(slots[i].out);
+  }
+  free(slots);
+}
+
+
+/** Allocate a writer's ring and start its threads. */
+static jbox_gzip_writer_t *start_writer(jbox_gzip_writer_t *w, int threads) {
+  w->count = (size_t)threads * 2 + 1;
+  w->slots = calloc(w->count, sizeof(gzip_slot_t));
+  if (!w->slots) {
+    free(w);
+    return NULL;
+  }
+  for (size_t i = 0; i < w->count; i++) {
+    w->slots[i].in = malloc(JBOX_GZIP_BLOCK);
+    if (w->zlib) w->slots[i].dict = malloc(JBOX_GZIP_WINDOW);
+    if (!w->slots[i].in || (w->zlib && !w->slots[i].dict)) {
+      free_slots(w->slots, w->count);
+      free(w);
+      return NULL;
+    }
+  }
+
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->work, NULL);
+  pthread_cond_init(&w->done, NULL);
+  for (int i = 0; i < threads; i++) {
+    if (pthread_create(&w->threads[w->started], NULL, gzip_worker, w) == 0) {
+      w->started++;
+    }
+  }
+  if (w->started == 0) {
+    jbox_gzip_writer_close(w, false);
+    return NULL;
+  }
+  return w;
+}
+
+
+jbox_gzip_writer_t *jbox_gzip_writer_new(int fd, int level, int threads) {
+  jbox_gzip_writer_t *w = calloc(1, sizeof(*w));
+  if (!w) return NULL;
+  w->fd = fd;
+  w->level = level;
+  w->sink = fd_sink;
+  w->sink_ctx = w;
+  return start_writer(w, thread_count(threads));
+}
+
+
+jbox_gzip_writer_t *jbox_gzip_zlib_writer_new(jbox_gzip_sink_fn sink,
+                                              void *ctx, int level,
+                                              int threads) {
+  jbox_gzip_writer_t *w = calloc(1, sizeof(*w));
+  if (!w) return NULL;
+  w->fd = -1;
+  w->level = level;
+  w->sink = sink;
+  w->sink_ctx = ctx;
+  w->zlib = true;
+  w->adler = (uint32_t)adler32(0, Z_NULL, 0);
+
+  threads = thread_count(threads);
+  if (threads > 1) return start_writer(w, threads);
+
+  w->z = calloc(1, sizeof(*w->z));
+  w->z_out = malloc(GZIP_STREAM_BUFFER);
+  if (!w->z || !w->z_out || deflateInit(w->z, level) != Z_OK) {
+    free(w->z);
+    free(w->z_out);
+    free(w);
+    return NULL;
+  }
+  return w;
+}
+
+
+int jbox_gzip_write(jbox_gzip_writer_t *w, const void *data, size_t len) {
+  if (w->z) {
+    if (w->error || stream_write(w, data, len, Z_NO_FLUSH) < 0) {
+      errno = w->error;
+      return -1;
+    }
+    return 0;
+  }
+
+  const unsigned char *p = data;
+  while (len > 0) {
+    if (w->error) {
+      errno = w->error;
+      return -1;
+    }
+    /* The slot to fill must have been written out */
+    if (w->filled - w->written == w->count && write_oldest(w) != 0) {
+      continue;
+    }
+
+    /* Blocks before the last are full, and the one before this is not
+     * filled again until this one is written */
+    gzip_slot_t *slot = &w->slots[w->filled % w->count];
+    if (w->zlib && slot->in_len == 0) {
+      slot->dict_len = 0;
+      if (w->filled > 0) {
+        const gzip_slot_t *prev = &w->slots[(w->filled - 1) % w->count];
+        memcpy(slot->dict, prev->in + JBOX_GZIP_BLOCK - JBOX_GZIP_WINDOW,
+               JBOX_GZIP_WINDOW);
+        slot->dict_len = JBOX_GZIP_WINDOW;
+      }
+    }
+    size_t n = JBOX_GZIP_BLOCK - slot->in_len;
+    if (n > len) n = len;
+    memcpy(slot->in + slot->in_len, p, n);
+    slot->in_len += n;
+    p += n;
+    len -= n;
+    if (slot->in_len == JBOX_GZIP_BLOCK) submit(w);
+  }
+  return 0;
+}
+
+
+/**
+ * End a zlib stream from the ring: an empty final block and the
+ * Adler-32, most significant byte first.
+ * @return 0 on success, -1 on error (w->error set).
+ */
+static int finish_zlib(jbox_gzip_writer_t *w) {
+  unsigned char trailer[6] = { 0x03, 0x00 };
+  trailer[2] = (unsigned char)(w->adler >> 24);
+  trailer[3] = (unsigned char)(w->adler >> 16);
+  trailer[4] = (unsigned char)(w->adler >> 8);
+  trailer[5] = (unsigned char)w->adler;
+  if (emit_header(w) < 0) return -1;
+  return emit(w, trailer, sizeof(trailer));
+}
+
+
+int jbox_gzip_writer_close(jbox_gzip_writer_t *w, bool finish) {
+  if (!w) return 0;
+
+  if (w->z) {
+    if (finish && !w->error) stream_write(w, NULL, 0, Z_FINISH);
+    deflateEnd(w->z);
+    free(w->z);
+    free(w->z_out);
+    int error = finish ? w->error : 0;
+    free(w);
+    if (error) {
+      errno = error;
+      return -1;
+    }
+    return 0;
+  }
+
+  if (finish && !w->error) {
+    /* The partial block, if any; empty input is still one member, as an
+     * empty file is not valid gzip */
+    gzip_slot_t *slot = &w->slots[w->filled % w->count];
+    if ((slot->in_len > 0 || (w->filled == 0 && !w->zlib)) &&
+        (w->filled - w->written < w->count || write_oldest(w) == 0)) {
+      submit(w);
+    }
+    while (!w->error && w->written < w->filled) write_oldest(w);
+    if (w->zlib && !w->error) finish_zlib(w);
+  } else if (!w->error) {
+    w->error = ECANCELED;
+  }
+
+  pthread_mutex_lock(&w->lock);
+  w->closed = true;
+  w->filled = w->taken;     /* Drop blocks no thread took */
+  pthread_cond_broadcast(&w->work);
+  pthread_mutex_unlock(&w->lock);
+  for (int i = 0; i < w->started; i++) pthread_join(w->threads[i], NULL);
+
+  pthread_cond_destroy(&w->work);
+  pthread_cond_destroy(&w->done);
+  pthread_mutex_destroy(&w->lock);
+  free_slots(w->slots, w->count);
+
+  int error = finish ? w->error : 0;
+  free(w);
+  if (error) {
+    errno = error;
+    return -1;
+  }
+  return 0;
+}
+
+
+// ---------------------------------------------------------------------------
+// Names
+// ---------------------------------------------------------------------------
+
+bool jbox_gzip_compressed_name(const char *name) {
+  static const char *const extensions[] = {
+    "gz", "tgz", "bz2", "xz", "zst", "lz4", "zip", "7z", "rar", "br",
+    "jpg", "jpeg", "png", "gif", "webp", "heic",
+    "mp3", "mp4", "mkv", "avi", "mov", "ogg", "flac",
+    "jar", "apk", "deb", "rpm", "docx", "xlsx", "woff2",
+  };
+
+  const char *dot = strrchr(name, '.');
+  if (!dot || strchr(dot, '/')) return false;
+  for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++) {
+    if (strcasecmp(dot + 1, extensions[i]) == 0) return true;
+  }
+  return false;
+}
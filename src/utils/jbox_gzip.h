@@ -0,0 +1,161 @@
+#ifndef JBOX_GZIP_H
+#define JBOX_GZIP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+
+/** Input bytes per gzip member written by the parallel writer */
+#define JBOX_GZIP_BLOCK (1024 * 1024)
+
+/** Bytes of the header at the start of each member */
+#define JBOX_GZIP_HEADER_LEN 20
+
+/** Upper bound on compressing threads */
+#define JBOX_GZIP_MAX_WORKERS 64
+
+/** Bytes of history each block of a zlib stream is primed with */
+#define JBOX_GZIP_WINDOW 32768
+
+
+/**
+ * Deflate state one thread reuses from member to member.
+ *
+ * Each member is a complete gzip stream that does not refer back into
+ * the ones before it, so blocks of an input can be compressed on
+ * different threads and concatenated; gzip and zlib read the result as
+ * one multi-member file. The header carries an extra field ("JB") with
+ * the member's compressed size, which lets a reader find where the next
+ * member starts without inflating this one.
+ */
+typedef struct jbox_gzip_deflater jbox_gzip_deflater_t;
+
+/**
+ * Parallel gzip compression of a stream of writes to a descriptor.
+ *
+ * Data written is cut into JBOX_GZIP_BLOCK members compressed by a pool
+ * of threads, a few blocks per thread in flight, and written to the
+ * descriptor in order by whichever call finds the oldest one done.
+ *
+ * A writer can instead make one zlib stream (RFC 1950), as FTP's MODE Z
+ * sends. Its blocks are raw deflate, each primed with the last
+ * JBOX_GZIP_WINDOW bytes of the block before and ended on a byte
+ * boundary with a sync flush, so that they join into a single deflate
+ * stream, as pigz makes them; the Adler-32 of the trailer is combined
+ * from the blocks'. Any inflater reads it.
+ */
+typedef struct jbox_gzip_writer jbox_gzip_writer_t;
+
+/**
+ * Where a zlib writer's output goes.
+ *
+ * @param ctx Caller's context
+ * @param data Compressed bytes
+ * @param len Number of bytes
+ * @return 0 on success, -1 on error (errno set)
+ */
+typedef int (*jbox_gzip_sink_fn)(void *ctx, const void *data, size_t len);
+
+
+/**
+ * Create deflate state.
+ *
+ * @param level zlib compression level, 1 to 9
+ * @return State, or NULL if out of memory
+ */
+jbox_gzip_deflater_t *jbox_gzip_deflater_new(int level);
+
+/**
+ * Compress a block into one gzip member.
+ *
+ * @param d Deflate state
+ * @param data Block to compress
+ * @param len Bytes in the block; may be 0
+ * @param out Buffer for the member, grown with realloc() as needed
+ * @param cap Allocated size of *out
+ * @param out_len Set to the member's size
+ * @return 0 on success, -1 if out of memory
+ */
+int jbox_gzip_member(jbox_gzip_deflater_t *d, const void *data, size_t len,
+                     unsigned char **out, size_t *cap, size_t *out_len);
+
+/**
+ * Free deflate state.
+ *
+ * @param d State, or NULL
+ */
+void jbox_gzip_deflater_free(jbox_gzip_deflater_t *d);
+
+/**
+ * Read the size of a member from its header.
+ *
+ * @param header First JBOX_GZIP_HEADER_LEN bytes of the member
+ * @return The member's size in bytes, or 0 if the header is not one
+ *         written by jbox_gzip_member()
+ */
+size_t jbox_gzip_member_size(const unsigned char *header);
+
+
+/**
+ * Start compressing to a descriptor.
+ *
+ * @param fd Descriptor to write; not closed
+ * @param level zlib compression level, 1 to 9
+ * @param threads Compressing threads; 0 for one per core
+ * @return Writer, or NULL if out of memory or no thread could start
+ */
+jbox_gzip_writer_t *jbox_gzip_writer_new(int fd, int level, int threads);
+
+/**
+ * Start compressing into one zlib stream handed to a sink.
+ *
+ * With one thread nothing is started: data is deflated as it is written,
+ * with no more than a small buffer held back, which suits short or slow
+ * inputs.
+ *
+ * @param sink Called, on the thread writing or closing, with the stream
+ *        in order
+ * @param ctx Passed to sink
+ * @param level zlib compression level, 0 (stored) to 9
+ * @param threads Compressing threads; 0 for one per core
+ * @return Writer, or NULL if out of memory or no thread could start
+ */
+jbox_gzip_writer_t *jbox_gzip_zlib_writer_new(jbox_gzip_sink_fn sink,
+                                              void *ctx, int level,
+                                              int threads);
+
+/**
+ * Compress data.
+ *
+ * @param w Writer
+ * @param data Bytes to compress
+ * @param len Number of bytes
+ * @return 0 on success, -1 if compressing or writing failed (errno set);
+ *         later calls fail too
+ */
+int jbox_gzip_write(jbox_gzip_writer_t *w, const void *data, size_t len);
+
+/**
+ * Stop the threads and free the writer.
+ *
+ * @param w Writer, or NULL
+ * @param finish true to compress and write everything still buffered
+ *        first, and end a zlib stream; false to drop it, after an error
+ *        elsewhere
+ * @return 0 if everything written reached the descriptor, -1 otherwise
+ *         (errno set)
+ */
+int jbox_gzip_writer_close(jbox_gzip_writer_t *w, bool finish);
+
+/**
+ * Tell from a file name whether its contents are compressed already
+ * (archives, images, audio, video, office documents), so that deflating
+ * them again would cost time and save nothing.
+ *
+ * @param name File name or path
+ * @return true if the extension is a known compressed format
+ */
+bool jbox_gzip_compressed_name(const char *name);
+
+
+#endif /* JBOX_GZIP_H */
@@ -0,0 +1,773 @@
+/**
+ * @file jbox_hash.c
+ * @brief SHA-256 and BLAKE3, shared by hashsum and the pkg cache.
+ *
+ * SHA-256 is a chain of dependent block compressions, so the only way to
+ * speed up one stream is a faster compression: the SHA instructions of
+ * x86-64 (SHA-NI) and AArch64 do a round pair per instruction. Which
+ * compression runs is decided once from the CPU's feature bits, and the
+ * portable one is kept for everything else.
+ *
+ * BLAKE3 hashes each 1 KiB chunk on its own and joins chunk chaining
+ * values pairwise into a tree, so independent compressions are always at
+ * hand. They are run eight at a time, one per lane of a vector of eight
+ * 32-bit words, built for AVX-512, for AVX2 and for the baseline target.
+ * Chunks are hashed as whole aligned subtrees wherever the input allows,
+ * which is also what lets callers spread a single input over threads.
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define JBOX_HASH_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define JBOX_HASH_ARM 1
+#endif
+
+#include "jbox_hash.h"
+
+
+// ---------------------------------------------------------------------------
+// Byte order
+// ---------------------------------------------------------------------------
+
+static inline uint32_t load_le32(const uint8_t *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+static inline void store_le32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+static inline uint32_t load_be32(const uint8_t *p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 |
+         (uint32_t)p[3];
+}
+
+static inline void store_be32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)(v >> 24);
+  p[1] = (uint8_t)(v >> 16);
+  p[2] = (uint8_t)(v >> 8);
+  p[3] = (uint8_t)v;
+}
+
+static inline uint32_t rotr32(uint32_t x, int n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+
+// ---------------------------------------------------------------------------
+// SHA-256 block compression
+// ---------------------------------------------------------------------------
+
+static const uint32_t SHA256_IV[8] = {
+  0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+  0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static const uint32_t SHA256_K[64] __attribute__((aligned(16))) = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+typedef void (*sha256_blocks_fn)(uint32_t state[8], const uint8_t *data,
+                                 size_t blocks);
+
+static void sha256_blocks_portable(uint32_t state[8], const uint8_t *data,
+                                   size_t blocks) {
+  while (blocks--) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+      w[i] = load_be32(data + 4 * i);
+    for (int i = 16; i < 64; i++) {
+      uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^
+                    (w[i - 15] >> 3);
+      uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^
+                    (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+      uint32_t s1 = rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25);
+      uint32_t ch = (e & f) ^ (~e & g);
+      uint32_t t1 = h + s1 + ch + SHA256_K[i] + w[i];
+      uint32_t s0 = rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22);
+      uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+      uint32_t t2 = s0 + maj;
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+    data += 64;
+  }
+}
+
+#ifdef JBOX_HASH_X86
+/*
+ * SHA-NI keeps the state as ABEF and CDGH halves, does two rounds per
+ * sha256rnds2 and extends the message schedule four words at a time with
+ * sha256msg1/msg2, so the 64 rounds are 16 groups over a ring of four
+ * message vectors.
+ */
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256_blocks_shani(uint32_t state[8], const uint8_t *data,
+                                size_t blocks) {
+  const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+                                       0x0405060700010203ULL);
+  __m128i tmp = _mm_loadu_si128((const __m128i *)&state[0]);
+  __m128i state1 = _mm_loadu_si128((const __m128i *)&state[4]);
+  tmp = _mm_shuffle_epi32(tmp, 0xb1);
+  state1 = _mm_shuffle_epi32(state1, 0x1b);
+  __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+  state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+  while (blocks--) {
+    __m128i abef = state0, cdgh = state1;
+    __m128i w[4];
+    for (int i = 0; i < 4; i++)
+      w[i] = _mm_shuffle_epi8(
+          _mm_loadu_si128((const __m128i *)(data + 16 * i)), bswap);
+
+#pragma GCC unroll 16
+    for (int g = 0; g < 16; g++) {
+      __m128i msg = _mm_add_epi32(
+          w[g & 3], _mm_load_si128((const __m128i *)&SHA256_K[4 * g]));
+      state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+      if (g >= 3 && g <= 14) {
+        __m128i next = _mm_add_epi32(
+            w[(g + 1) & 3], _mm_alignr_epi8(w[g & 3], w[(g + 3) & 3], 4));
+        w[(g + 1) & 3] = _mm_sha256msg2_epu32(next, w[g & 3]);
+      }
+      state0 = _mm_sha256rnds2_epu32(state0, state1,
+                                     _mm_shuffle_epi32(msg, 0x0e));
+      if (g >= 1 && g <= 12)
+        w[(g + 3) & 3] = _mm_sha256msg1_epu32(w[(g + 3) & 3], w[g & 3]);
+    }
+
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+    data += 64;
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1b);
+  state1 = _mm_shuffle_epi32(state1, 0xb1);
+  state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+  state1 = _mm_alignr_epi8(state1, tmp, 8);
+  _mm_storeu_si128((__m128i *)&state[0], state0);
+  _mm_storeu_si128((__m128i *)&state[4], state1);
+}
+#endif
+
+#ifdef JBOX_HASH_ARM
+/*
+ * The ARMv8 SHA-256 instructions keep the state as ABCD and EFGH, do four
+ * rounds per sha256h/sha256h2 pair and extend the schedule with
+ * sha256su0/su1.
+ */
+__attribute__((target("+crypto")))
+static void sha256_blocks_armv8(uint32_t state[8], const uint8_t *data,
+                                size_t blocks) {
+  uint32x4_t state0 = vld1q_u32(&state[0]);
+  uint32x4_t state1 = vld1q_u32(&state[4]);
+
+  while (blocks--) {
+    uint32x4_t abcd = state0, efgh = state1;
+    uint32x4_t w[4];
+    for (int i = 0; i < 4; i++)
+      w[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16 * i)));
+
+#pragma GCC unroll 16
+    for (int g = 0; g < 16; g++) {
+      uint32x4_t msg = vaddq_u32(w[g & 3], vld1q_u32(&SHA256_K[4 * g]));
+      if (g < 12)
+        w[g & 3] = vsha256su0q_u32(w[g & 3], w[(g + 1) & 3]);
+      uint32x4_t prev = state0;
+      state0 = vsha256hq_u32(state0, state1, msg);
+      state1 = vsha256h2q_u32(state1, prev, msg);
+      if (g < 12)
+        w[g & 3] = vsha256su1q_u32(w[g & 3], w[(g + 2) & 3], w[(g + 3) & 3]);
+    }
+
+    state0 = vaddq_u32(state0, abcd);
+    state1 = vaddq_u32(state1, efgh);
+    data += 64;
+  }
+
+  vst1q_u32(&state[0], state0);
+  vst1q_u32(&state[4], state1);
+}
+#endif
+
+static sha256_blocks_fn sha256_blocks = sha256_blocks_portable;
+static const char *sha256_impl_name = "portable";
+static pthread_once_t sha256_once = PTHREAD_ONCE_INIT;
+
+static void sha256_pick(void) {
+#ifdef JBOX_HASH_X86
+  unsigned int a, b, c, d;
+  if (__get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSE4_1) && (c & bit_SSSE3) &&
+      __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & bit_SHA)) {
+    sha256_blocks = sha256_blocks_shani;
+    sha256_impl_name = "sha-ni";
+  }
+#elif defined(JBOX_HASH_ARM)
+  if (getauxval(AT_HWCAP) & HWCAP_SHA2) {
+    sha256_blocks = sha256_blocks_armv8;
+    sha256_impl_name = "armv8";
+  }
+#endif
+}
+
+
+// ---------------------------------------------------------------------------
+// SHA-256
+// ---------------------------------------------------------------------------
+
+void jbox_sha256_init(jbox_sha256_t *ctx) {
+  pthread_once(&sha256_once, sha256_pick);
+  memcpy(ctx->state, SHA256_IV, sizeof(ctx->state));
+  ctx->total = 0;
+  ctx->block_len = 0;
+}
+
+void jbox_sha256_update(jbox_sha256_t *ctx, const void *data, size_t len) {
+  const uint8_t *p = data;
+  ctx->total += len;
+
+  if (ctx->block_len > 0) {
+    size_t take = 64 - ctx->block_len;
+    if (take > len)
+      take = len;
+    memcpy(ctx->block + ctx->block_len, p, take);
+    ctx->block_len += take;
+    p += take;
+    len -= take;
+    if (ctx->block_len < 64)
+      return;
+    sha256_blocks(ctx->state, ctx->block, 1);
+    ctx->block_len = 0;
+  }
+
+  if (len >= 64) {
+    sha256_blocks(ctx->state, p, len / 64);
+    p += len & ~(size_t)63;
+    len &= 63;
+  }
+
+  memcpy(ctx->block, p, len);
+  ctx->block_len = len;
+}
+
+void jbox_sha256_final(jbox_sha256_t *ctx, uint8_t out[JBOX_SHA256_LEN]) {
+  uint64_t bits = ctx->total * 8;
+
+  ctx->block[ctx->block_len++] = 0x80;
+  if (ctx->block_len > 56) {
+    memset(ctx->block + ctx->block_len, 0, 64 - ctx->block_len);
+    sha256_blocks(ctx->state, ctx->block, 1);
+    ctx->block_len = 0;
+  }
+  memset(ctx->block + ctx->block_len, 0, 56 - ctx->block_len);
+  store_be32(ctx->block + 56, (uint32_t)(bits >> 32));
+  store_be32(ctx->block + 60, (uint32_t)bits);
+  sha256_blocks(ctx->state, ctx->block, 1);
+
+  for (int i = 0; i < 8; i++)
+    store_be32(out + 4 * i, ctx->state[i]);
+}
+
+const char *jbox_sha256_impl(void) {
+  pthread_once(&sha256_once, sha256_pick);
+  return sha256_impl_name;
+}
+
+
+// ---------------------------------------------------------------------------
+// BLAKE3 compression
+// ---------------------------------------------------------------------------
+
+enum {
+  B3_CHUNK_START = 1 << 0,
+  B3_CHUNK_END   = 1 << 1,
+  B3_PARENT      = 1 << 2,
+  B3_ROOT        = 1 << 3,
+};
+
+/** Chunks hashed into one buffer of chaining values before reducing it */
+#define B3_BATCH_CHUNKS 64
+
+static const uint32_t B3_IV[8] = {
+  0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+  0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+/** Message word order of each of the seven rounds */
+static const uint8_t B3_SCHEDULE[7][16] = {
+  {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+  {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+  {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+  {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+  {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+  {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+  {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13},
+};
+
+#define B3_G(v, a, b, c, d, x, y, rot)                                       \
+  do {                                                                       \
+    v[a] = v[a] + v[b] + (x);                                                \
+    v[d] = rot(v[d] ^ v[a], 16);                                             \
+    v[c] = v[c] + v[d];                                                      \
+    v[b] = rot(v[b] ^ v[c], 12);                                             \
+    v[a] = v[a] + v[b] + (y);                                                \
+    v[d] = rot(v[d] ^ v[a], 8);                                              \
+    v[c] = v[c] + v[d];                                                      \
+    v[b] = rot(v[b] ^ v[c], 7);                                              \
+  } while (0)
+
+#define B3_ROUND(v, m, s, rot)                                               \
+  do {                                                                       \
+    B3_G(v, 0, 4, 8, 12, m[s[0]], m[s[1]], rot);                             \
+    B3_G(v, 1, 5, 9, 13, m[s[2]], m[s[3]], rot);                             \
+    B3_G(v, 2, 6, 10, 14, m[s[4]], m[s[5]], rot);                            \
+    B3_G(v, 3, 7, 11, 15, m[s[6]], m[s[7]], rot);                            \
+    B3_G(v, 0, 5, 10, 15, m[s[8]], m[s[9]], rot);                            \
+    B3_G(v, 1, 6, 11, 12, m[s[10]], m[s[11]], rot);                          \
+    B3_G(v, 2, 7, 8, 13, m[s[12]], m[s[13]], rot);                           \
+    B3_G(v, 3, 4, 9, 14, m[s[14]], m[s[15]], rot);                           \
+  } while (0)
+
+/** Compress one block; cv is replaced by the first half of the output */
+static void b3_compress(uint32_t cv[8], const uint8_t block[64],
+                        uint32_t block_len, uint64_t counter, uint32_t flags) {
+  uint32_t m[16], v[16];
+  for (int i = 0; i < 16; i++)
+    m[i] = load_le32(block + 4 * i);
+  for (int i = 0; i < 8; i++)
+    v[i] = cv[i];
+  for (int i = 0; i < 4; i++)
+    v[8 + i] = B3_IV[i];
+  v[12] = (uint32_t)counter;
+  v[13] = (uint32_t)(counter >> 32);
+  v[14] = block_len;
+  v[15] = flags;
+
+  for (int r = 0; r < 7; r++)
+    B3_ROUND(v, m, B3_SCHEDULE[r], rotr32);
+
+  for (int i = 0; i < 8; i++)
+    cv[i] = v[i] ^ v[i + 8];
+}
+
+typedef uint32_t b3_vec __attribute__((vector_size(32)));
+typedef uint8_t b3_bytes __attribute__((vector_size(32)));
+
+/*
+ * Rotations by whole bytes are a byte shuffle where that is one
+ * instruction (AVX2) but no rotate instruction is (AVX-512 has one).
+ */
+#define B3_ROTR_SHIFT(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define B3_ROTR_BYTES(x, n)                                                  \
+  ((n) % 8 == 0 && byte_rotate                                               \
+       ? (b3_vec)__builtin_shuffle((b3_bytes)(x),                            \
+                                   (n) == 16 ? rot16 : rot8)                 \
+       : B3_ROTR_SHIFT(x, n))
+
+/**
+ * Load one block of each of eight inputs, transposed so that m[i] holds
+ * message word i of every input.
+ */
+static inline __attribute__((always_inline)) void
+b3_load_block(const uint8_t *data, size_t stride, b3_vec m[16]) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  // Each half block is an 8x8 word matrix, transposed by interleaving
+  // words, then word pairs, then 16-byte halves.
+  const b3_vec lo32 = {0, 8, 1, 9, 4, 12, 5, 13};
+  const b3_vec hi32 = {2, 10, 3, 11, 6, 14, 7, 15};
+  const b3_vec lo64 = {0, 1, 8, 9, 4, 5, 12, 13};
+  const b3_vec hi64 = {2, 3, 10, 11, 6, 7, 14, 15};
+  const b3_vec lo128 = {0, 1, 2, 3, 8, 9, 10, 11};
+  const b3_vec hi128 = {4, 5, 6, 7, 12, 13, 14, 15};
+
+  for (int half = 0; half < 2; half++) {
+    b3_vec r[8], t[8], u[8];
+    for (int j = 0; j < 8; j++)
+      memcpy(&r[j], data + j * stride + 32 * half, sizeof(r[j]));
+    for (int j = 0; j < 8; j += 2) {
+      t[j] = __builtin_shuffle(r[j], r[j + 1], lo32);
+      t[j + 1] = __builtin_shuffle(r[j], r[j + 1], hi32);
+    }
+    for (int j = 0; j < 8; j += 4) {
+      u[j] = __builtin_shuffle(t[j], t[j + 2], lo64);
+      u[j + 1] = __builtin_shuffle(t[j], t[j + 2], hi64);
+      u[j + 2] = __builtin_shuffle(t[j + 1], t[j + 3], lo64);
+      u[j + 3] = __builtin_shuffle(t[j + 1], t[j + 3], hi64);
+    }
+    b3_vec *w = m + 8 * half;
+    for (int i = 0; i < 4; i++) {
+      w[i] = __builtin_shuffle(u[i], u[i + 4], lo128);
+      w[i + 4] = __builtin_shuffle(u[i], u[i + 4], hi128);
+    }
+  }
+#else
+  for (int j = 0; j < 8; j++)
+    for (int i = 0; i < 16; i++)
+      m[i][j] = load_le32(data + j * stride + 4 * i);
+#endif
+}
+
+/**
+ * Hash eight inputs of the same number of whole blocks at once, one per
+ * vector lane, writing each final chaining value as 32 bytes to out.
+ * Input j starts at data + j * stride and gets counter + j when increment
+ * is set, counter otherwise.
+ */
+static inline __attribute__((always_inline)) void
+b3_hash8_body(const uint8_t *data, size_t stride, size_t blocks,
+              uint64_t counter, bool increment, uint32_t flags,
+              uint32_t flags_start, uint32_t flags_end, uint8_t *out,
+              bool byte_rotate) {
+  const b3_bytes rot16 = {2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                          18, 19, 16, 17, 22, 23, 20, 21, 26, 27, 24, 25, 30,
+                          31, 28, 29};
+  const b3_bytes rot8 = {1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12,
+                         17, 18, 19, 16, 21, 22, 23, 20, 25, 26, 27, 24, 29,
+                         30, 31, 28};
+  b3_vec h[8], lo, hi;
+  for (int i = 0; i < 8; i++)
+    h[i] = (b3_vec){0} + B3_IV[i];
+  for (int j = 0; j < 8; j++) {
+    uint64_t c = counter + (increment ? (uint64_t)j : 0);
+    lo[j] = (uint32_t)c;
+    hi[j] = (uint32_t)(c >> 32);
+  }
+
+  for (size_t b = 0; b < blocks; b++) {
+    uint32_t block_flags = flags;
+    if (b == 0)
+      block_flags |= flags_start;
+    if (b + 1 == blocks)
+      block_flags |= flags_end;
+
+    b3_vec m[16], v[16];
+    b3_load_block(data + 64 * b, stride, m);
+
+    for (int i = 0; i < 8; i++)
+      v[i] = h[i];
+    for (int i = 0; i < 4; i++)
+      v[8 + i] = (b3_vec){0} + B3_IV[i];
+    v[12] = lo;
+    v[13] = hi;
+    v[14] = (b3_vec){0} + 64;
+    v[15] = (b3_vec){0} + block_flags;
+
+#pragma GCC unroll 7
+    for (int r = 0; r < 7; r++)
+      B3_ROUND(v, m, B3_SCHEDULE[r], B3_ROTR_BYTES);
+
+    for (int i = 0; i < 8; i++)
+      h[i] = v[i] ^ v[i + 8];
+  }
+
+  for (int j = 0; j < 8; j++)
+    for (int i = 0; i < 8; i++)
+      store_le32(out + 32 * j + 4 * i, h[i][j]);
+}
+
+#ifdef JBOX_HASH_X86
+__attribute__((target("avx512f,avx512vl")))
+static void b3_hash8_avx512(const uint8_t *data, size_t stride, size_t blocks,
+                            uint64_t counter, bool increment, uint32_t flags,
+                            uint32_t flags_start, uint32_t flags_end,
+                            uint8_t *out) {
+  b3_hash8_body(data, stride, blocks, counter, increment, flags, flags_start,
+                flags_end, out, false);
+}
+
+__attribute__((target("avx2")))
+static void b3_hash8_avx2(const uint8_t *data, size_t stride, size_t blocks,
+                          uint64_t counter, bool increment, uint32_t flags,
+                          uint32_t flags_start, uint32_t flags_end,
+                          uint8_t *out) {
+  b3_hash8_body(data, stride, blocks, counter, increment, flags, flags_start,
+                flags_end, out, true);
+}
+#endif
+
+static void b3_hash8_generic(const uint8_t *data, size_t stride, size_t blocks,
+                             uint64_t counter, bool increment, uint32_t flags,
+                             uint32_t flags_start, uint32_t flags_end,
+                             uint8_t *out) {
+  b3_hash8_body(data, stride, blocks, counter, increment, flags, flags_start,
+                flags_end, out, false);
+}
+
+typedef void (*b3_hash8_fn)(const uint8_t *data, size_t stride, size_t blocks,
+                            uint64_t counter, bool increment, uint32_t flags,
+                            uint32_t flags_start, uint32_t flags_end,
+                            uint8_t *out);
+
+static b3_hash8_fn b3_hash8 = b3_hash8_generic;
+static pthread_once_t b3_once = PTHREAD_ONCE_INIT;
+
+static void b3_pick(void) {
+#ifdef JBOX_HASH_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl"))
+    b3_hash8 = b3_hash8_avx512;
+  else if (__builtin_cpu_supports("avx2"))
+    b3_hash8 = b3_hash8_avx2;
+#endif
+}
+
+/** b3_hash8 over any number of evenly spaced inputs, the rest one by one */
+static void b3_hash_many(const uint8_t *data, size_t stride, size_t n,
+                         size_t blocks, uint64_t counter, bool increment,
+                         uint32_t flags, uint32_t flags_start,
+                         uint32_t flags_end, uint8_t *out) {
+  while (n >= 8) {
+    b3_hash8(data, stride, blocks, counter, increment, flags, flags_start,
+             flags_end, out);
+    data += 8 * stride;
+    n -= 8;
+    if (increment)
+      counter += 8;
+    out += 8 * 32;
+  }
+  for (; n > 0; n--) {
+    uint32_t cv[8];
+    memcpy(cv, B3_IV, sizeof(cv));
+    for (size_t b = 0; b < blocks; b++) {
+      uint32_t block_flags = flags;
+      if (b == 0)
+        block_flags |= flags_start;
+      if (b + 1 == blocks)
+        block_flags |= flags_end;
+      b3_compress(cv, data + 64 * b, 64, counter, block_flags);
+    }
+    for (int i = 0; i < 8; i++)
+      store_le32(out + 4 * i, cv[i]);
+    data += stride;
+    if (increment)
+      counter++;
+    out += 32;
+  }
+}
+
+/**
+ * Hash a power-of-two run of whole chunks, at most B3_BATCH_CHUNKS, down
+ * to one chaining value: the chunks first, then each level of parents,
+ * every level in place over the one below.
+ */
+static void b3_batch(const uint8_t *data, size_t chunks, uint64_t counter,
+                     uint8_t cv[32]) {
+  uint8_t cvs[B3_BATCH_CHUNKS * 32];
+
+  b3_hash_many(data, JBOX_BLAKE3_CHUNK, chunks, JBOX_BLAKE3_CHUNK / 64,
+               counter, true, 0, B3_CHUNK_START, B3_CHUNK_END, cvs);
+  for (size_t n = chunks; n > 1; n /= 2)
+    b3_hash_many(cvs, 64, n / 2, 1, 0, false, B3_PARENT, 0, 0, cvs);
+  memcpy(cv, cvs, 32);
+}
+
+static void b3_subtree(const uint8_t *data, size_t chunks, uint64_t counter,
+                       uint8_t cv[32]) {
+  if (chunks <= B3_BATCH_CHUNKS) {
+    b3_batch(data, chunks, counter, cv);
+    return;
+  }
+
+  uint8_t pair[64];
+  size_t half = chunks / 2;
+  b3_subtree(data, half, counter, pair);
+  b3_subtree(data + half * JBOX_BLAKE3_CHUNK, half, counter + half, pair + 32);
+
+  uint32_t out[8];
+  memcpy(out, B3_IV, sizeof(out));
+  b3_compress(out, pair, 64, 0, B3_PARENT);
+  for (int i = 0; i < 8; i++)
+    store_le32(cv + 4 * i, out[i]);
+}
+
+
+// ---------------------------------------------------------------------------
+// BLAKE3
+// ---------------------------------------------------------------------------
+
+static void b3_reset_chunk(jbox_blake3_t *ctx) {
+  memcpy(ctx->chunk_cv, B3_IV, sizeof(ctx->chunk_cv));
+  ctx->block_len = 0;
+  ctx->blocks_done = 0;
+}
+
+static void b3_parent_cv(const uint32_t left[8], const uint32_t right[8],
+                         uint32_t flags, uint32_t out[8]) {
+  uint8_t block[64];
+  for (int i = 0; i < 8; i++) {
+    store_le32(block + 4 * i, left[i]);
+    store_le32(block + 32 + 4 * i, right[i]);
+  }
+  memcpy(out, B3_IV, 8 * sizeof(uint32_t));
+  b3_compress(out, block, 64, 0, B3_PARENT | flags);
+}
+
+void jbox_blake3_init(jbox_blake3_t *ctx) {
+  pthread_once(&b3_once, b3_pick);
+  ctx->cv_depth = 0;
+  ctx->chunk_counter = 0;
+  b3_reset_chunk(ctx);
+}
+
+void jbox_blake3_add_subtree(jbox_blake3_t *ctx, const uint32_t cv[8],
+                             size_t chunks) {
+  uint32_t merged[8];
+  memcpy(merged, cv, sizeof(merged));
+
+  // The stack holds one value per set bit of the chunk count, so adding
+  // 2^k chunks merges upwards while the new count has zero bits from k on.
+  uint64_t total = ctx->chunk_counter + chunks;
+  for (uint64_t bit = chunks; (total & bit) == 0; bit <<= 1) {
+    ctx->cv_depth--;
+    b3_parent_cv(ctx->cv_stack[ctx->cv_depth], merged, 0, merged);
+  }
+  memcpy(ctx->cv_stack[ctx->cv_depth++], merged, sizeof(merged));
+  ctx->chunk_counter = total;
+  b3_reset_chunk(ctx);
+}
+
+void jbox_blake3_update(jbox_blake3_t *ctx, const void *data, size_t len) {
+  const uint8_t *p = data;
+
+  while (len > 0) {
+    // The current chunk is full and more input follows, so it is not the
+    // root: finish it and start the next.
+    if (ctx->blocks_done == JBOX_BLAKE3_CHUNK / 64 - 1 &&
+        ctx->block_len == 64) {
+      b3_compress(ctx->chunk_cv, ctx->block, 64, ctx->chunk_counter,
+                  B3_CHUNK_END);
+      uint32_t cv[8];
+      memcpy(cv, ctx->chunk_cv, sizeof(cv));
+      jbox_blake3_add_subtree(ctx, cv, 1);
+    }
+
+    // At a chunk boundary, hash the largest aligned subtree that is not
+    // the end of the input straight from the caller's buffer.
+    if (ctx->blocks_done == 0 && ctx->block_len == 0 &&
+        len > JBOX_BLAKE3_CHUNK) {
+      size_t chunks = 1;
+      while (chunks * 2 * JBOX_BLAKE3_CHUNK < len &&
+             (ctx->chunk_counter & (chunks * 2 - 1)) == 0)
+        chunks *= 2;
+      uint8_t bytes[32];
+      uint32_t cv[8];
+      b3_subtree(p, chunks, ctx->chunk_counter, bytes);
+      for (int i = 0; i < 8; i++)
+        cv[i] = load_le32(bytes + 4 * i);
+      jbox_blake3_add_subtree(ctx, cv, chunks);
+      p += chunks * JBOX_BLAKE3_CHUNK;
+      len -= chunks * JBOX_BLAKE3_CHUNK;
+      continue;
+    }
+
+    // A full block is only compressed once more input shows it is not
+    // the last of the chunk.
+    if (ctx->block_len == 64) {
+      b3_compress(ctx->chunk_cv, ctx->block, 64, ctx->chunk_counter,
+                  ctx->blocks_done == 0 ? B3_CHUNK_START : 0);
+      ctx->blocks_done++;
+      ctx->block_len = 0;
+    }
+    size_t take = 64 - ctx->block_len;
+    if (take > len)
+      take = len;
+    memcpy(ctx->block + ctx->block_len, p, take);
+    ctx->block_len += take;
+    p += take;
+    len -= take;
+  }
+}
+
+void jbox_blake3_final(jbox_blake3_t *ctx, uint8_t out[JBOX_BLAKE3_LEN]) {
+  uint32_t flags = B3_CHUNK_END;
+  if (ctx->blocks_done == 0)
+    flags |= B3_CHUNK_START;
+  memset(ctx->block + ctx->block_len, 0, 64 - ctx->block_len);
+
+  uint32_t cv[8];
+  memcpy(cv, ctx->chunk_cv, sizeof(cv));
+  if (ctx->cv_depth == 0) {
+    b3_compress(cv, ctx->block, (uint32_t)ctx->block_len, ctx->chunk_counter,
+                flags | B3_ROOT);
+  } else {
+    b3_compress(cv, ctx->block, (uint32_t)ctx->block_len, ctx->chunk_counter,
+                flags);
+    for (size_t i = ctx->cv_depth - 1; i > 0; i--)
+      b3_parent_cv(ctx->cv_stack[i], cv, 0, cv);
+    b3_parent_cv(ctx->cv_stack[0], cv, B3_ROOT, cv);
+  }
+
+  for (int i = 0; i < 8; i++)
+    store_le32(out + 4 * i, cv[i]);
+}
+
+void jbox_blake3_subtree(const void *data, size_t chunks,
+                         uint64_t first_chunk, uint32_t cv[8]) {
+  uint8_t bytes[32];
+
+  pthread_once(&b3_once, b3_pick);
+  b3_subtree(data, chunks, first_chunk, bytes);
+  for (int i = 0; i < 8; i++)
+    cv[i] = load_le32(bytes + 4 * i);
+}
+
+
+// ---------------------------------------------------------------------------
+// Hex
+// ---------------------------------------------------------------------------
+
+void jbox_hash_hex(const uint8_t *digest, size_t len, char *hex) {
+  static const char digits[] = "0123456789abcdef";
+
+  for (size_t i = 0; i < len; i++) {
+    hex[2 * i] = digits[digest[i] >> 4];
+    hex[2 * i + 1] = digits[digest[i] & 15];
+  }
+  hex[2 * len] = '\0';
+}
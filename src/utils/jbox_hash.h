@@ -0,0 +1,148 @@
+#ifndef JBOX_HASH_H
+#define JBOX_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/** Bytes in a SHA-256 digest */
+#define JBOX_SHA256_LEN 32
+
+/** Bytes in a BLAKE3 digest (the default output length) */
+#define JBOX_BLAKE3_LEN 32
+
+/** Bytes in a BLAKE3 chunk, the leaves of its tree */
+#define JBOX_BLAKE3_CHUNK 1024
+
+/** Levels of chaining values a BLAKE3 hasher keeps; enough for 2^64 bytes */
+#define JBOX_BLAKE3_MAX_DEPTH 54
+
+
+/**
+ * Incremental SHA-256.
+ *
+ * Whole blocks are compressed with the SHA extensions (SHA-NI on x86-64,
+ * the ARMv8 crypto extensions on AArch64) when the CPU has them, and in
+ * portable C otherwise; the choice is made once, on first use.
+ */
+typedef struct {
+  uint32_t state[8];
+  uint64_t total;           /**< Bytes hashed so far */
+  uint8_t block[64];        /**< Partial block */
+  size_t block_len;
+} jbox_sha256_t;
+
+
+/**
+ * Incremental BLAKE3 (unkeyed, 32-byte output).
+ *
+ * BLAKE3 hashes 1 KiB chunks independently and joins them in a binary
+ * tree, so large inputs can be split across threads: hash whole subtrees
+ * with jbox_blake3_subtree(), then feed their chaining values in order
+ * with jbox_blake3_add_subtree() before the rest of the input. Chunks are
+ * compressed eight at a time across SIMD lanes where that helps.
+ */
+typedef struct {
+  uint32_t cv_stack[JBOX_BLAKE3_MAX_DEPTH][8];
+  size_t cv_depth;
+  uint32_t chunk_cv[8];     /**< Chaining value of the current chunk */
+  uint64_t chunk_counter;   /**< Index of the current chunk */
+  uint8_t block[64];        /**< Partial block of the current chunk */
+  size_t block_len;
+  size_t blocks_done;       /**< Blocks of the current chunk compressed */
+} jbox_blake3_t;
+
+
+/**
+ * Start a SHA-256 hash.
+ *
+ * @param ctx Hash state to initialize
+ */
+void jbox_sha256_init(jbox_sha256_t *ctx);
+
+/**
+ * Add data to a SHA-256 hash.
+ *
+ * @param ctx Hash state
+ * @param data Bytes to hash
+ * @param len Number of bytes
+ */
+void jbox_sha256_update(jbox_sha256_t *ctx, const void *data, size_t len);
+
+/**
+ * Finish a SHA-256 hash.
+ *
+ * @param ctx Hash state; must be initialized again before reuse
+ * @param out Set to the digest
+ */
+void jbox_sha256_final(jbox_sha256_t *ctx, uint8_t out[JBOX_SHA256_LEN]);
+
+/**
+ * Name the SHA-256 implementation in use: "sha-ni", "armv8" or
+ * "portable".
+ */
+const char *jbox_sha256_impl(void);
+
+
+/**
+ * Start a BLAKE3 hash.
+ *
+ * @param ctx Hash state to initialize
+ */
+void jbox_blake3_init(jbox_blake3_t *ctx);
+
+/**
+ * Add data to a BLAKE3 hash.
+ *
+ * @param ctx Hash state
+ * @param data Bytes to hash
+ * @param len Number of bytes
+ */
+void jbox_blake3_update(jbox_blake3_t *ctx, const void *data, size_t len);
+
+/**
+ * Finish a BLAKE3 hash.
+ *
+ * @param ctx Hash state; must be initialized again before reuse
+ * @param out Set to the digest
+ */
+void jbox_blake3_final(jbox_blake3_t *ctx, uint8_t out[JBOX_BLAKE3_LEN]);
+
+/**
+ * Hash a whole subtree of the BLAKE3 tree, for splitting one input
+ * across threads. Safe to call from several threads at once.
+ *
+ * @param data The subtree's bytes: chunks * JBOX_BLAKE3_CHUNK of them
+ * @param chunks Chunks in the subtree; a power of two
+ * @param first_chunk Index of the subtree's first chunk in the input; a
+ *        multiple of chunks
+ * @param cv Set to the subtree's chaining value
+ */
+void jbox_blake3_subtree(const void *data, size_t chunks,
+                         uint64_t first_chunk, uint32_t cv[8]);
+
+/**
+ * Add a subtree hashed by jbox_blake3_subtree() to a hash, in place of
+ * its bytes. The hash must hold nothing but earlier subtrees of the same
+ * size, so that the subtree starts where the hash stands; more data may
+ * follow, and at least one byte must before the hash is finished.
+ *
+ * @param ctx Hash state
+ * @param cv The subtree's chaining value
+ * @param chunks Chunks in the subtree
+ */
+void jbox_blake3_add_subtree(jbox_blake3_t *ctx, const uint32_t cv[8],
+                             size_t chunks);
+
+
+/**
+ * Write a digest as lowercase hex.
+ *
+ * @param digest Digest bytes
+ * @param len Number of bytes
+ * @param hex Set to 2 * len hex digits and a NUL
+ */
+void jbox_hash_hex(const uint8_t *digest, size_t len, char *hex);
+
+
+#endif /* JBOX_HASH_H */
@@ -0,0 +1,786 @@
+/**
+ * @file jbox_http.c
+ * @brief Process-wide pool of curl handles for jbox's HTTP clients.
+ *
+ * All handles share one curl share handle, so the DNS, TLS session and
+ * connection caches outlive any single request. Released handles are
+ * kept idle, up to JBOX_HTTP_POOL_SIZE, and reset when handed out
+ * again; curl_easy_reset() clears options but keeps a handle's buffers,
+ * which saves setting them up per request.
+ *
+ * jbox_http_batch() runs many requests at once on a curl multi handle,
+ * drawing its easy handles from the same pool, and
+ * jbox_http_download_segments() splits one large download into byte
+ * ranges fetched the same way.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "jbox_http.h"
+
+
+/** Idle easy handles kept for reuse */
+#define JBOX_HTTP_POOL_SIZE 8
+
+
+/** Guards everything below */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static CURLSH *share;
+static CURL *idle[JBOX_HTTP_POOL_SIZE];
+static int idle_count;
+static int acquired;                  /* Handles handed out, not returned */
+static bool cleanup_registered;
+
+/** One lock per kind of data in the share handle */
+static pthread_mutex_t share_locks[CURL_LOCK_DATA_LAST];
+
+
+/**
+ * Locks shared data for libcurl (CURLSHOPT_LOCKFUNC).
+ */
+static void share_lock(CURL *curl, curl_lock_data data,
+                       curl_lock_access access, void *userptr) {
+  (void)curl;
+  (void)access;
+  (void)userptr;
+  pthread_mutex_lock(&share_locks[data]);
+}
+
+
+/**
+ * Unlocks shared data for libcurl (CURLSHOPT_UNLOCKFUNC).
+ */
+static void share_unlock(CURL *curl, curl_lock_data data, void *userptr) {
+  (void)curl;
+  (void)userptr;
+  pthread_mutex_unlock(&share_locks[data]);
+}
+
+
+/**
+ * Creates the share handle. Called with pool_lock held.
+ *
+ * @return 0 on success, -1 on error
+ */
+static int share_init(void) {
+  if (!cleanup_registered) {
+    if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+      return -1;
+    }
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+      pthread_mutex_init(&share_locks[i], NULL);
+    }
+    atexit(jbox_http_cleanup);
+    cleanup_registered = true;
+  }
+
+  share = curl_share_init();
+  if (!share) {
+    return -1;
+  }
+  curl_share_setopt(share, CURLSHOPT_LOCKFUNC, share_lock);
+  curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+  curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+  curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+  return 0;
+}
+
+
+CURL *jbox_http_acquire(void) {
+  pthread_mutex_lock(&pool_lock);
+
+  if (!share && share_init() != 0) {
+    pthread_mutex_unlock(&pool_lock);
+    return NULL;
+  }
+
+  CURL *curl = idle_count > 0 ? idle[--idle_count] : NULL;
+  if (curl) {
+    curl_easy_reset(curl);
+  } else {
+    curl = curl_easy_init();
+  }
+  if (curl) {
+    curl_easy_setopt(curl, CURLOPT_SHARE, share);
+    acquired++;
+  }
+
+  pthread_mutex_unlock(&pool_lock);
+  return curl;
+}
+
+
+void jbox_http_release(CURL *curl) {
+  if (!curl) {
+    return;
+  }
+
+  pthread_mutex_lock(&pool_lock);
+  acquired--;
+  if (idle_count < JBOX_HTTP_POOL_SIZE) {
+    idle[idle_count++] = curl;
+    curl = NULL;
+  }
+  pthread_mutex_unlock(&pool_lock);
+
+  // Cleaned up outside the lock; it may close a connection
+  if (curl) {
+    curl_easy_cleanup(curl);
+  }
+}
+
+
+void jbox_http_cleanup(void) {
+  pthread_mutex_lock(&pool_lock);
+
+  while (idle_count > 0) {
+    curl_easy_cleanup(idle[--idle_count]);
+  }
+  if (share && acquired == 0) {
+    curl_share_cleanup(share);
+    share = NULL;
+  }
+
+  pthread_mutex_unlock(&pool_lock);
+}
+
+
+/** One request of a batch, from start until it is reported */
+typedef struct {
+  CURL *curl;
+  char *body;
+  size_t size;
+  size_t capacity;
+  char *content_type;
+  CURLcode result;
+  long http_code;
+  double seconds;
+  bool done;
+} batch_slot_t;
+
+
+/** State of a running batch */
+typedef struct {
+  const jbox_http_request_t *requests;
+  size_t count;
+  const jbox_http_batch_opts_t *opts;
+  batch_slot_t *slots;
+  size_t next_report;         /* First request not reported, in order mode */
+  int failed;
+  jbox_http_batch_fn fn;
+  void *ctx;
+} batch_t;
+
+
+/**
+ * Appends received body data to a batch slot (CURLOPT_WRITEFUNCTION).
+ */
+static size_t batch_write(void *contents, size_t size, size_t nmemb,
+                          void *userp) {
+  size_t realsize = size * nmemb;
+  batch_slot_t *slot = userp;
+
+  if (slot->size + realsize >= slot->capacity) {
+    size_t capacity = slot->capacity ? slot->capacity * 2 : 4096;
+    while (capacity < slot->size + realsize + 1) {
+      capacity *= 2;
+    }
+    char *body = realloc(slot->body, capacity);
+    if (!body) {
+      return 0;
+    }
+    slot->body = body;
+    slot->capacity = capacity;
+  }
+
+  memcpy(slot->body + slot->size, contents, realsize);
+  slot->size += realsize;
+  slot->body[slot->size] = '\0';
+  return realsize;
+}
+
+
+/**
+ * Aborts a transfer once the batch is interrupted
+ * (CURLOPT_XFERINFOFUNCTION).
+ */
+static int batch_progress(void *clientp, curl_off_t dltotal,
+                          curl_off_t dlnow, curl_off_t ultotal,
+                          curl_off_t ulnow) {
+  (void)dltotal;
+  (void)dlnow;
+  (void)ultotal;
+  (void)ulnow;
+  const jbox_http_batch_opts_t *opts = clientp;
+  return opts->interrupted() ? 1 : 0;
+}
+
+
+/**
+ * Reports a finished request and frees what it held.
+ */
+static void batch_report(batch_t *batch, size_t i) {
+  batch_slot_t *slot = &batch->slots[i];
+  jbox_http_response_t response = {
+    .index = i,
+    .url = batch->requests[i].url,
+    .result = slot->result,
+    .http_code = slot->http_code,
+    .content_type = slot->content_type,
+    .body = slot->body ? slot->body : "",
+    .body_size = slot->size,
+    .seconds = slot->seconds
+  };
+  if (slot->result != CURLE_OK || slot->http_code >= 400) {
+    batch->failed++;
+  }
+  batch->fn(&response, batch->ctx);
+
+  free(slot->body);
+  free(slot->content_type);
+  slot->body = NULL;
+  slot->content_type = NULL;
+}
+
+
+/**
+ * Records a request as finished, and reports it and any held back
+ * behind it.
+ */
+static void batch_finish(batch_t *batch, size_t i) {
+  batch->slots[i].done = true;
+  if (!batch->opts->in_order) {
+    batch_report(batch, i);
+    return;
+  }
+  while (batch->next_report < batch->count
+         && batch->slots[batch->next_report].done) {
+    batch_report(batch, batch->next_report++);
+  }
+}
+
+
+/**
+ * Sets up and adds the transfer of request i.
+ * @return 0 on success, -1 if it could not be started
+ */
+static int batch_start(batch_t *batch, CURLM *multi, size_t i) {
+  const jbox_http_request_t *request = &batch->requests[i];
+  const jbox_http_batch_opts_t *opts = batch->opts;
+  batch_slot_t *slot = &batch->slots[i];
+
+  CURL *curl = jbox_http_acquire();
+  if (!curl) {
+    return -1;
+  }
+  curl_easy_setopt(curl, CURLOPT_URL, request->url);
+  if (request->post_data) {
+    curl_easy_setopt(curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request->post_data);
+  }
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, batch_write);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, slot);
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 10L);
+  curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+  if (opts->user_agent) {
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, opts->user_agent);
+  }
+  if (opts->headers) {
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, opts->headers);
+  }
+  if (opts->interrupted) {
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, batch_progress);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, (void *)opts);
+  }
+
+  // Wait for a connection that can multiplex rather than open another
+  curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+  curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+  curl_easy_setopt(curl, CURLOPT_PRIVATE, slot);
+
+  if (curl_multi_add_handle(multi, curl) != CURLM_OK) {
+    jbox_http_release(curl);
+    return -1;
+  }
+  slot->curl = curl;
+  return 0;
+}
+
+
+int jbox_http_batch(const jbox_http_request_t *requests, size_t count,
+                    const jbox_http_batch_opts_t *opts,
+                    jbox_http_batch_fn fn, void *ctx) {
+  if (count == 0) {
+    return 0;
+  }
+
+  int max_parallel = opts->max_parallel > 0 ? opts->max_parallel
+                                            : JBOX_HTTP_BATCH_PARALLEL;
+  batch_t batch = {
+    .requests = requests,
+    .count = count,
+    .opts = opts,
+    .slots = calloc(count, sizeof(batch_slot_t)),
+    .fn = fn,
+    .ctx = ctx
+  };
+  CURLM *multi = curl_multi_init();
+  if (!batch.slots || !multi) {
+    free(batch.slots);
+    curl_multi_cleanup(multi);
+    return -1;
+  }
+  curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+  curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+                    (long)max_parallel);
+
+  size_t next = 0;
+  int active = 0;
+  while (next < count || active > 0) {
+    bool interrupted = opts->interrupted && opts->interrupted();
+
+    // Keep max_parallel transfers going; after an interrupt, start none
+    // and report the rest as aborted
+    while (next < count && (active < max_parallel || interrupted)) {
+      if (interrupted) {
+        batch.slots[next].result = CURLE_ABORTED_BY_CALLBACK;
+        batch_finish(&batch, next);
+      } else if (batch_start(&batch, multi, next) == 0) {
+        active++;
+      } else {
+        batch.slots[next].result = CURLE_FAILED_INIT;
+        batch_finish(&batch, next);
+      }
+      next++;
+    }
+    if (active == 0) {
+      continue;
+    }
+
+    int running = 0;
+    curl_multi_perform(multi, &running);
+
+    CURLMsg *msg;
+    int queued;
+    while ((msg = curl_multi_info_read(multi, &queued)) != NULL) {
+      if (msg->msg != CURLMSG_DONE) {
+        continue;
+      }
+
+      CURL *curl = msg->easy_handle;
+      batch_slot_t *slot = NULL;
+      char *content_type = NULL;
+      curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&slot);
+      curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &slot->http_code);
+      curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &slot->seconds);
+      curl_easy_getinfo(curl, CURLINFO_CONTENT_TYPE, &content_type);
+      slot->content_type = content_type ? strdup(content_type) : NULL;
+      slot->result = msg->data.result;
+
+      curl_multi_remove_handle(multi, curl);
+      jbox_http_release(curl);
+      slot->curl = NULL;
+      active--;
+      batch_finish(&batch, (size_t)(slot - batch.slots));
+    }
+
+    if (active > 0) {
+      curl_multi_poll(multi, NULL, 0, 1000, NULL);
+    }
+  }
+
+  curl_multi_cleanup(multi);
+  free(batch.slots);
+  return batch.failed;
+}
+
+
+/** What the HEAD request of a segmented download learned */
+typedef struct {
+  bool ranges;                /* Accept-Ranges: bytes */
+  char *etag;                 /* Strong ETag, or NULL */
+  char *last_modified;        /* Or NULL */
+} probe_t;
+
+
+/** One byte range of a segmented download */
+typedef struct {
+  int fd;
+  curl_off_t next;            /* Next byte to fetch and write */
+  curl_off_t end;             /* One past the last byte */
+  int attempts;
+  bool rejected;              /* The server sent something other than the
+                                 range; not worth retrying */
+  CURL *curl;                 /* While in flight */
+} segment_t;
+
+
+/**
+ * Copies a header's value, trimmed. Replaces *field.
+ */
+static void probe_set(char **field, const char *value, const char *end) {
+  while (value < end && (*value == ' ' || *value == '\t')) value++;
+  while (end > value && (end[-1] == '\r' || end[-1] == '\n'
+                         || end[-1] == ' ')) {
+    end--;
+  }
+  free(*field);
+  *field = strndup(value, (size_t)(end - value));
+}
+
+
+/**
+ * Notes the headers a segmented download depends on
+ * (CURLOPT_HEADERFUNCTION). A status line starts over, so only the
+ * response after the last redirect counts.
+ */
+static size_t probe_header(char *buffer, size_t size, size_t nitems,
+                           void *userdata) {
+  size_t len = size * nitems;
+  probe_t *probe = userdata;
+  const char *end = buffer + len;
+
+  if (len > 5 && strncmp(buffer, "HTTP/", 5) == 0) {
+    free(probe->etag);
+    free(probe->last_modified);
+    *probe = (probe_t){0};
+  } else if (len > 14 && strncasecmp(buffer, "Accept-Ranges:", 14) == 0) {
+    probe->ranges = memmem(buffer + 14, len - 14, "bytes", 5) != NULL;
+  } else if (len > 5 && strncasecmp(buffer, "ETag:", 5) == 0) {
+    probe_set(&probe->etag, buffer + 5, end);
+    // A weak ETag may not be used with If-Range
+    if (probe->etag && strncmp(probe->etag, "W/", 2) == 0) {
+      free(probe->etag);
+      probe->etag = NULL;
+    }
+  } else if (len > 14 && strncasecmp(buffer, "Last-Modified:", 14) == 0) {
+    probe_set(&probe->last_modified, buffer + 14, end);
+  }
+  return len;
+}
+
+
+/**
+ * Writes a segment's bytes in place (CURLOPT_WRITEFUNCTION). Anything
+ * but a 206 for the range asked for aborts the transfer: a 200 means
+ * the server ignored the range or If-Range found the body changed.
+ */
+static size_t segment_write(void *contents, size_t size, size_t nmemb,
+                            void *userp) {
+  size_t len = size * nmemb;
+  segment_t *seg = userp;
+
+  long http_code = 0;
+  curl_easy_getinfo(seg->curl, CURLINFO_RESPONSE_CODE, &http_code);
+  if (http_code != 206 || (curl_off_t)len > seg->end - seg->next) {
+    seg->rejected = http_code == 200 || http_code == 206;
+    return 0;
+  }
+
+  const char *p = contents;
+  size_t left = len;
+  while (left > 0) {
+    ssize_t n = pwrite(seg->fd, p, left, (off_t)seg->next);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      seg->rejected = true;
+      return 0;
+    }
+    p += n;
+    left -= (size_t)n;
+    seg->next += n;
+  }
+  return len;
+}
+
+
+/**
+ * Aborts a segment once the download is interrupted
+ * (CURLOPT_XFERINFOFUNCTION).
+ */
+static int segment_progress(void *clientp, curl_off_t dltotal,
+                            curl_off_t dlnow, curl_off_t ultotal,
+                            curl_off_t ulnow) {
+  (void)dltotal;
+  (void)dlnow;
+  (void)ultotal;
+  (void)ulnow;
+  const jbox_http_segment_opts_t *opts = clientp;
+  return opts->interrupted() ? 1 : 0;
+}
+
+
+/**
+ * Sets up and adds the transfer of what is left of a segment.
+ * @return 0 on success, -1 if it could not be started
+ */
+static int segment_start(CURLM *multi, segment_t *seg, const char *url,
+                         struct curl_slist *headers,
+                         const jbox_http_segment_opts_t *opts) {
+  CURL *curl = jbox_http_acquire();
+  if (!curl) {
+    return -1;
+  }
+
+  char range[64];
+  snprintf(range, sizeof(range), "%" CURL_FORMAT_CURL_OFF_T "-%"
+           CURL_FORMAT_CURL_OFF_T, seg->next, seg->end - 1);
+  curl_easy_setopt(curl, CURLOPT_URL, url);
+  curl_easy_setopt(curl, CURLOPT_RANGE, range);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, segment_write);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, seg);
+  if (headers) {
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+  }
+  if (opts->user_agent) {
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, opts->user_agent);
+  }
+  if (opts->timeout > 0) {
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, opts->timeout);
+  }
+  if (opts->interrupted) {
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, segment_progress);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, (void *)opts);
+  }
+  curl_easy_setopt(curl, CURLOPT_PRIVATE, seg);
+
+  seg->curl = curl;
+  seg->rejected = false;
+  if (curl_multi_add_handle(multi, curl) != CURLM_OK) {
+    seg->curl = NULL;
+    jbox_http_release(curl);
+    return -1;
+  }
+  return 0;
+}
+
+
+/**
+ * Asks for the size of a download and whether it can be split.
+ * @param url URL to ask about
+ * @param opts How to run the request
+ * @param probe Filled in from the headers
+ * @param size Set to the body size, or -1 if not reported
+ * @param final_url Set to the URL after redirects, to be freed
+ * @param out Transport result and status filled in
+ * @return 0 on success, -1 on error
+ */
+static int segment_probe(const char *url, const jbox_http_segment_opts_t *opts,
+                         probe_t *probe, curl_off_t *size, char **final_url,
+                         jbox_http_segment_result_t *out) {
+  CURL *curl = jbox_http_acquire();
+  if (!curl) {
+    out->result = CURLE_FAILED_INIT;
+    return -1;
+  }
+  curl_easy_setopt(curl, CURLOPT_URL, url);
+  curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 10L);
+  curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, probe_header);
+  curl_easy_setopt(curl, CURLOPT_HEADERDATA, probe);
+  if (opts->headers) {
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, opts->headers);
+  }
+  if (opts->user_agent) {
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, opts->user_agent);
+  }
+  if (opts->timeout > 0) {
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, opts->timeout);
+  }
+
+  out->result = curl_easy_perform(curl);
+  char *effective = NULL;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &out->http_code);
+  curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, size);
+  curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &effective);
+  *final_url = strdup(effective ? effective : url);
+  jbox_http_release(curl);
+
+  if (out->result != CURLE_OK || out->http_code >= 400 || !*final_url) {
+    return -1;
+  }
+  return 0;
+}
+
+
+int jbox_http_download_segments(const char *url, int fd, int segments,
+                                const jbox_http_segment_opts_t *opts,
+                                jbox_http_segment_result_t *result) {
+  jbox_http_segment_result_t out = {0};
+  probe_t probe = {0};
+  curl_off_t size = -1;
+  char *final_url = NULL;
+  struct curl_slist *headers = NULL;
+  segment_t *segs = NULL;
+  CURLM *multi = NULL;
+  int rc = -1;
+
+  if (segment_probe(url, opts, &probe, &size, &final_url, &out) != 0) {
+    goto done;
+  }
+
+  // Each segment should be worth a connection of its own
+  curl_off_t count = segments < JBOX_HTTP_MAX_SEGMENTS
+                     ? segments : JBOX_HTTP_MAX_SEGMENTS;
+  if (size >= 0 && count > size / JBOX_HTTP_MIN_SEGMENT) {
+    count = size / JBOX_HTTP_MIN_SEGMENT;
+  }
+  if (!probe.ranges || size < 0 || count < 2) {
+    rc = JBOX_HTTP_NO_RANGES;
+    goto done;
+  }
+
+  // Room for the whole body up front, so a full disk fails now
+  int err = ftruncate(fd, (off_t)size) == 0 ? 0 : errno;
+  if (err == 0) {
+    err = posix_fallocate(fd, 0, (off_t)size);
+    if (err == EOPNOTSUPP || err == EINVAL) {
+      err = 0;
+    }
+  }
+  if (err != 0) {
+    out.result = CURLE_WRITE_ERROR;
+    goto done;
+  }
+
+  for (struct curl_slist *h = opts->headers; h; h = h->next) {
+    headers = curl_slist_append(headers, h->data);
+  }
+  const char *validator = probe.etag ? probe.etag : probe.last_modified;
+  if (validator) {
+    char if_range[512];
+    snprintf(if_range, sizeof(if_range), "If-Range: %s", validator);
+    headers = curl_slist_append(headers, if_range);
+  }
+
+  segs = calloc((size_t)count, sizeof(segment_t));
+  multi = curl_multi_init();
+  if (!segs || !multi) {
+    out.result = CURLE_OUT_OF_MEMORY;
+    goto done;
+  }
+  // One connection per segment: several TCP streams are the point, so
+  // they must not be multiplexed onto one
+  curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_NOTHING);
+
+  int active = 0;
+  bool failed = false;
+  for (curl_off_t i = 0; i < count; i++) {
+    segs[i].fd = fd;
+    segs[i].next = size * i / count;
+    segs[i].end = size * (i + 1) / count;
+    if (segment_start(multi, &segs[i], final_url, headers, opts) != 0) {
+      out.result = CURLE_FAILED_INIT;
+      failed = true;
+      break;
+    }
+    active++;
+  }
+
+  while (active > 0 && !failed) {
+    int running = 0;
+    curl_multi_perform(multi, &running);
+
+    CURLMsg *msg;
+    int queued;
+    while ((msg = curl_multi_info_read(multi, &queued)) != NULL) {
+      if (msg->msg != CURLMSG_DONE) {
+        continue;
+      }
+
+      CURL *curl = msg->easy_handle;
+      segment_t *seg = NULL;
+      long http_code = 0;
+      curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&seg);
+      curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+      CURLcode res = msg->data.result;
+      curl_multi_remove_handle(multi, curl);
+      jbox_http_release(curl);
+      seg->curl = NULL;
+      active--;
+
+      if (res == CURLE_OK && seg->next == seg->end) {
+        continue;
+      }
+      bool interrupted = opts->interrupted && opts->interrupted();
+      if (!seg->rejected && !interrupted
+          && seg->attempts < JBOX_HTTP_SEGMENT_RETRIES) {
+        // Resume from the last byte written
+        seg->attempts++;
+        out.retries++;
+        if (segment_start(multi, seg, final_url, headers, opts) == 0) {
+          active++;
+          continue;
+        }
+      }
+      out.result = interrupted ? CURLE_ABORTED_BY_CALLBACK
+                   : res != CURLE_OK ? res : CURLE_PARTIAL_FILE;
+      if (http_code != 206) {
+        out.http_code = http_code;
+      }
+      failed = true;
+    }
+
+    if (active > 0 && !failed) {
+      curl_multi_poll(multi, NULL, 0, 1000, NULL);
+    }
+  }
+
+  // One failed segment fails the download; stop the rest
+  for (curl_off_t i = 0; i < count; i++) {
+    if (segs[i].curl) {
+      curl_multi_remove_handle(multi, segs[i].curl);
+      jbox_http_release(segs[i].curl);
+      segs[i].curl = NULL;
+    }
+  }
+  if (failed) {
+    goto done;
+  }
+
+  // Every range complete and the file exactly the size announced
+  struct stat st;
+  for (curl_off_t i = 0; i < count; i++) {
+    if (segs[i].next != segs[i].end) {
+      failed = true;
+    }
+  }
+  if (failed || fstat(fd, &st) != 0 || (curl_off_t)st.st_size != size) {
+    out.result = CURLE_PARTIAL_FILE;
+    goto done;
+  }
+  out.size = size;
+  out.segments = (int)count;
+  rc = 0;
+
+done:
+  curl_multi_cleanup(multi);
+  free(segs);
+  curl_slist_free_all(headers);
+  free(final_url);
+  free(probe.etag);
+  free(probe.last_modified);
+  if (result) {
+    *result = out;
+  }
+  return rc;
+}
@@ -0,0 +1,171 @@
+#ifndef JBOX_HTTP_H
+#define JBOX_HTTP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <curl/curl.h>
+
+/** Transfers a batch runs at once unless told otherwise */
+#define JBOX_HTTP_BATCH_PARALLEL 16
+
+/**
+ * One request of a batch.
+ */
+typedef struct {
+  const char *url;
+  const char *post_data;      /* Body to POST, or NULL for a GET */
+} jbox_http_request_t;
+
+/**
+ * Outcome of one request of a batch, as handed to the callback.
+ * The strings are only valid during the call.
+ */
+typedef struct {
+  size_t index;               /* Position of the request in the batch */
+  const char *url;
+  CURLcode result;            /* CURLE_ABORTED_BY_CALLBACK if interrupted */
+  long http_code;
+  const char *content_type;   /* Or NULL */
+  const char *body;           /* NUL-terminated; body_size bytes */
+  size_t body_size;
+  double seconds;             /* Total time of the transfer */
+} jbox_http_response_t;
+
+/**
+ * Called once per request of a batch.
+ */
+typedef void (*jbox_http_batch_fn)(const jbox_http_response_t *response,
+                                   void *ctx);
+
+/**
+ * How a batch is run.
+ */
+typedef struct {
+  struct curl_slist *headers; /* Extra request headers, or NULL */
+  const char *user_agent;     /* Or NULL */
+  int max_parallel;           /* Most transfers in flight; 0 for default */
+  bool in_order;              /* Report in request order, not as each
+                                 request completes */
+  bool (*interrupted)(void);  /* Polled to abort the batch, or NULL */
+} jbox_http_batch_opts_t;
+
+/** Largest number of segments a download is split into */
+#define JBOX_HTTP_MAX_SEGMENTS 64
+
+/** Smallest segment worth its own request; smaller files get fewer */
+#define JBOX_HTTP_MIN_SEGMENT (256 * 1024)
+
+/** Times one segment is resumed after a failure before giving up */
+#define JBOX_HTTP_SEGMENT_RETRIES 3
+
+/** jbox_http_download_segments() could not split the download */
+#define JBOX_HTTP_NO_RANGES 1
+
+/**
+ * How a segmented download is run.
+ */
+typedef struct {
+  struct curl_slist *headers; /* Extra request headers, or NULL */
+  const char *user_agent;     /* Or NULL */
+  long timeout;               /* Seconds per request; 0 for none */
+  bool (*interrupted)(void);  /* Polled to abort the download, or NULL */
+} jbox_http_segment_opts_t;
+
+/**
+ * Outcome of a segmented download.
+ */
+typedef struct {
+  CURLcode result;            /* CURLE_ABORTED_BY_CALLBACK if interrupted */
+  long http_code;
+  curl_off_t size;            /* Bytes written to the file */
+  int segments;               /* Segments fetched */
+  int retries;                /* Segment resumes after failures */
+} jbox_http_segment_result_t;
+
+/**
+ * Get a curl easy handle from the process-wide pool.
+ *
+ * Every handle the pool hands out is attached to one curl share
+ * handle, which holds the DNS cache, the TLS session cache and the
+ * connection cache. A request to a host that an earlier request in
+ * the process has already talked to reuses its open connection, or at
+ * least resumes its TLS session, instead of starting from a new TCP
+ * and TLS handshake. The handle comes back with all options at their
+ * defaults, apart from CURLOPT_SHARE.
+ *
+ * Safe to call from several threads; the share handle is locked by
+ * libcurl around every use of the caches.
+ *
+ * @return A handle to be given back with jbox_http_release(), or NULL
+ *         if curl could not be initialized
+ */
+CURL *jbox_http_acquire(void);
+
+/**
+ * Give a handle from jbox_http_acquire() back to the pool.
+ *
+ * Handles beyond what the pool keeps idle are cleaned up. The
+ * connections they used stay in the shared cache either way.
+ *
+ * @param curl Handle to give back; NULL is ignored
+ */
+void jbox_http_release(CURL *curl);
+
+/**
+ * Close the pooled handles and the shared caches.
+ *
+ * Registered with atexit() the first time a handle is acquired; only
+ * needs calling directly to drop idle connections early. While any
+ * handle is still acquired the shared caches are left as they are.
+ */
+void jbox_http_cleanup(void);
+
+/**
+ * Run several requests at once on one curl multi handle.
+ *
+ * Requests to the same host are multiplexed over one HTTP/2 connection
+ * where the server allows it, and otherwise kept alive and reused; all
+ * of them go through the pool's shared DNS and TLS session caches.
+ * Response bodies are collected in memory, so this suits many small
+ * requests rather than large downloads. Out-of-order completions are
+ * held back until their turn when opts->in_order is set.
+ *
+ * @param requests Requests to run
+ * @param count Number of requests
+ * @param opts How to run them
+ * @param fn Called once per request with its outcome
+ * @param ctx Passed to fn
+ * @return Number of requests that failed (a transport error or an HTTP
+ *         status of 400 or more), or -1 if the batch could not be run
+ */
+int jbox_http_batch(const jbox_http_request_t *requests, size_t count,
+                    const jbox_http_batch_opts_t *opts,
+                    jbox_http_batch_fn fn, void *ctx);
+
+/**
+ * Download a URL into a file over several connections at once.
+ *
+ * A HEAD request finds the size of the body and whether the server
+ * takes byte ranges. The file is then preallocated at that size and
+ * split into up to segments ranges, fetched in parallel on one curl
+ * multi handle and written in place with pwrite(). A segment that
+ * fails is resumed from its last byte, up to JBOX_HTTP_SEGMENT_RETRIES
+ * times. Every range request carries If-Range with the validator from
+ * the HEAD, so a body that changes mid-download fails instead of being
+ * stitched together from two versions, and the download only succeeds
+ * once every segment has delivered exactly its bytes.
+ *
+ * @param url URL to download; redirects are followed by the HEAD
+ * @param fd File to write, open for writing; truncated to the body size
+ * @param segments Most ranges to fetch at once
+ * @param opts How to run the download
+ * @param result Filled in with the outcome, or NULL
+ * @return 0 on success, JBOX_HTTP_NO_RANGES if the server does not
+ *         report a size or take ranges (or the body is too small to
+ *         split), having written nothing, or -1 on error
+ */
+int jbox_http_download_segments(const char *url, int fd, int segments,
+                                const jbox_http_segment_opts_t *opts,
+                                jbox_http_segment_result_t *result);
+
+#endif /* JBOX_HTTP_H */
@@ -0,0 +1,583 @@
+/**
+ * @file jbox_http_cache.c
+ * @brief On-disk cache of HTTP responses for jbox's HTTP clients.
+ *
+ * Responses live in ~/.jshell/http-cache, one slot per URL and set of
+ * request headers. A slot's .meta file is small text read on every
+ * lookup; its .body file is only mapped once the response is used.
+ * Both are written to temporary names and renamed into place, so a
+ * reader sees a whole entry or none; a body whose size disagrees with
+ * the meta file, as when a reader races a writer, counts as a miss.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "jbox_http_cache.h"
+
+
+/** First line of every .meta file */
+#define CACHE_MAGIC "JBOXHTTPCACHE 1"
+
+
+/**
+ * Gets the user's home directory.
+ * @return Home directory, or NULL if not found
+ */
+static const char *home_directory(void) {
+  const char *home = getenv("HOME");
+  if (home != NULL && home[0] != '\0') {
+    return home;
+  }
+
+  struct passwd *pw = getpwuid(getuid());
+  if (pw != NULL && pw->pw_dir != NULL) {
+    return pw->pw_dir;
+  }
+
+  return NULL;
+}
+
+
+/**
+ * Hashes bytes into a running FNV-1a hash.
+ * @param hash Hash so far
+ * @param data Bytes to add
+ * @param len Number of bytes
+ * @return Updated hash
+ */
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t len) {
+  const unsigned char *p = data;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= p[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+
+/**
+ * Builds the path of the slot for a request, making the cache directory
+ * if needed.
+ * @param url Requested URL
+ * @param req_headers Extra request headers
+ * @return Allocated slot path without extension, or NULL on error
+ */
+static char *slot_path(const char *url,
+                       const struct curl_slist *req_headers) {
+  const char *home = home_directory();
+  if (home == NULL) {
+    return NULL;
+  }
+
+  uint64_t hash = fnv1a(0xcbf29ce484222325ULL, url, strlen(url));
+  for (const struct curl_slist *h = req_headers; h != NULL; h = h->next) {
+    hash = fnv1a(hash, "\n", 1);
+    hash = fnv1a(hash, h->data, strlen(h->data));
+  }
+
+  size_t len = strlen(home) + strlen(JBOX_HTTP_CACHE_SUBPATH) + 18;
+  char *path = malloc(len);
+  if (path == NULL) {
+    return NULL;
+  }
+
+  snprintf(path, len, "%s/.jshell", home);
+  if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+    free(path);
+    return NULL;
+  }
+  snprintf(path, len, "%s%s", home, JBOX_HTTP_CACHE_SUBPATH);
+  if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+    free(path);
+    return NULL;
+  }
+  snprintf(path, len, "%s%s/%016llx", home, JBOX_HTTP_CACHE_SUBPATH,
+           (unsigned long long)hash);
+  return path;
+}
+
+
+/**
+ * Builds the path of one of a slot's files.
+ * @param entry Located slot
+ * @param suffix Extension, with its dot
+ * @return Allocated path, or NULL if out of memory
+ */
+static char *slot_file(const jbox_http_cache_entry_t *entry,
+                       const char *suffix) {
+  size_t len = strlen(entry->path) + strlen(suffix) + 1;
+  char *path = malloc(len);
+  if (path != NULL) {
+    snprintf(path, len, "%s%s", entry->path, suffix);
+  }
+  return path;
+}
+
+
+/**
+ * Builds a temporary path next to one of a slot's files.
+ * @param entry Located slot
+ * @param suffix Extension of the file it will replace
+ * @return Allocated path, or NULL if out of memory
+ */
+static char *slot_tmp_file(const jbox_http_cache_entry_t *entry,
+                           const char *suffix) {
+  size_t len = strlen(entry->path) + strlen(suffix) + 32;
+  char *path = malloc(len);
+  if (path != NULL) {
+    snprintf(path, len, "%s%s.%ld.tmp", entry->path, suffix, (long)getpid());
+  }
+  return path;
+}
+
+
+/**
+ * Forgets the response loaded into an entry, keeping the slot.
+ * @param entry Entry to clear
+ */
+static void unload(jbox_http_cache_entry_t *entry) {
+  if (entry->body != NULL) {
+    munmap((void *)entry->body, entry->body_size);
+  }
+  free(entry->headers);
+  free(entry->meta);
+  entry->found = false;
+  entry->http_code = 0;
+  entry->stored = 0;
+  entry->headers = NULL;
+  entry->header_count = 0;
+  entry->body = NULL;
+  entry->body_size = 0;
+  entry->meta = NULL;
+}
+
+
+/**
+ * Reads a whole small file.
+ * @param path File to read
+ * @return Allocated NUL-terminated contents, or NULL on error
+ */
+static char *read_file(const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  struct stat st;
+  char *data = NULL;
+  if (fstat(fd, &st) == 0 && st.st_size < 1024 * 1024) {
+    data = malloc((size_t)st.st_size + 1);
+  }
+  if (data != NULL) {
+    ssize_t n = read(fd, data, (size_t)st.st_size);
+    if (n != st.st_size) {
+      free(data);
+      data = NULL;
+    } else {
+      data[n] = '\0';
+    }
+  }
+  close(fd);
+  return data;
+}
+
+
+/**
+ * Loads the response stored in a slot, if it is for url and whole.
+ * @param entry Located slot
+ * @param url Requested URL
+ */
+static void load(jbox_http_cache_entry_t *entry, const char *url) {
+  char *meta_path = slot_file(entry, ".meta");
+  char *body_path = slot_file(entry, ".body");
+  entry->meta = meta_path ? read_file(meta_path) : NULL;
+
+  // Split into lines: magic, "code stored size", URL, then the headers
+  size_t lines = 0;
+  for (char *p = entry->meta; p && *p; p++) {
+    lines += *p == '\n';
+  }
+  char **line = entry->meta ? malloc((lines + 1) * sizeof(char *)) : NULL;
+  size_t n = 0;
+  for (char *p = entry->meta; line && p && *p; n++) {
+    line[n] = p;
+    p = strchr(p, '\n');
+    if (p == NULL) {
+      break;
+    }
+    *p++ = '\0';
+  }
+
+  long long stored = 0;
+  unsigned long long size = 0;
+  bool valid = line != NULL && n >= 3
+               && strcmp(line[0], CACHE_MAGIC) == 0
+               && sscanf(line[1], "%ld %lld %llu", &entry->http_code,
+                         &stored, &size) == 3
+               && strcmp(line[2], url) == 0;
+
+  int fd = valid && body_path ? open(body_path, O_RDONLY | O_CLOEXEC) : -1;
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || (unsigned long long)st.st_size != size) {
+    valid = false;
+  } else if (size > 0) {
+    void *map = mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      valid = false;
+    } else {
+      entry->body = map;
+      entry->body_size = (size_t)size;
+    }
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+
+  if (valid) {
+    memmove(line, line + 3, (n - 3) * sizeof(char *));
+    entry->headers = line;
+    entry->header_count = n - 3;
+    entry->stored = (time_t)stored;
+    entry->found = true;
+  } else {
+    free(line);
+    unload(entry);
+  }
+  free(meta_path);
+  free(body_path);
+}
+
+
+int jbox_http_cache_open(jbox_http_cache_entry_t *entry, const char *url,
+                         const struct curl_slist *req_headers) {
+  memset(entry, 0, sizeof(*entry));
+  entry->path = slot_path(url, req_headers);
+  if (entry->path == NULL) {
+    return -1;
+  }
+  load(entry, url);
+  return 0;
+}
+
+
+void jbox_http_cache_close(jbox_http_cache_entry_t *entry) {
+  if (entry->tmp != NULL) {
+    fclose(entry->tmp);
+    unlink(entry->tmp_path);
+  }
+  free(entry->tmp_path);
+  unload(entry);
+  free(entry->path);
+  memset(entry, 0, sizeof(*entry));
+}
+
+
+const char *jbox_http_cache_header(char *const *headers, size_t count,
+                                   const char *name) {
+  size_t len = strlen(name);
+  for (size_t i = count; i-- > 0;) {
+    if (strncasecmp(headers[i], name, len) == 0 && headers[i][len] == ':') {
+      const char *value = headers[i] + len + 1;
+      while (*value == ' ' || *value == '\t') {
+        value++;
+      }
+      return value;
+    }
+  }
+  return NULL;
+}
+
+
+/**
+ * Looks for a directive in a Cache-Control value.
+ * @param value Header value
+ * @param directive Directive name
+ * @param arg Set to the directive's number, if it has one; may be NULL
+ * @return true if the directive is present
+ */
+static bool cache_directive(const char *value, const char *directive,
+                            long *arg) {
+  size_t len = strlen(directive);
+  for (const char *p = value; *p;) {
+    p += strspn(p, " \t,");
+    if (strncasecmp(p, directive, len) == 0
+        && strchr("=, \t", p[len]) != NULL) {
+      if (arg != NULL) {
+        *arg = p[len] == '=' ? strtol(p + len + 1 + (p[len + 1] == '"'),
+                                      NULL, 10)
+                             : 0;
+      }
+      return true;
+    }
+    p += strcspn(p, ",");
+  }
+  return false;
+}
+
+
+/**
+ * Works out how long a response stays fresh.
+ * @param headers Header lines of the response
+ * @param count Number of lines
+ * @param stored When the response was generated, for a missing Date
+ * @return Freshness lifetime in seconds; 0 if it must always be
+ *         revalidated
+ */
+static long freshness_lifetime(char *const *headers, size_t count,
+                               time_t stored) {
+  const char *cc = jbox_http_cache_header(headers, count, "Cache-Control");
+  long max_age;
+  if (cc != NULL) {
+    if (cache_directive(cc, "no-cache", NULL)
+        || cache_directive(cc, "no-store", NULL)) {
+      return 0;
+    }
+    if (cache_directive(cc, "max-age", &max_age)) {
+      return max_age > 0 ? max_age : 0;
+    }
+  } else {
+    const char *pragma = jbox_http_cache_header(headers, count, "Pragma");
+    if (pragma != NULL && cache_directive(pragma, "no-cache", NULL)) {
+      return 0;
+    }
+  }
+
+  const char *value = jbox_http_cache_header(headers, count, "Date");
+  time_t date = value ? curl_getdate(value, NULL) : -1;
+  if (date == -1) {
+    date = stored;
+  }
+
+  // An Expires that cannot be parsed means already expired
+  value = jbox_http_cache_header(headers, count, "Expires");
+  if (value != NULL) {
+    time_t expires = curl_getdate(value, NULL);
+    return expires > date ? (long)(expires - date) : 0;
+  }
+
+  value = jbox_http_cache_header(headers, count, "Last-Modified");
+  time_t modified = value ? curl_getdate(value, NULL) : -1;
+  if (modified != -1 && modified < date) {
+    long lifetime = (long)(date - modified) / 10;
+    return lifetime < JBOX_HTTP_CACHE_HEURISTIC_MAX
+           ? lifetime : JBOX_HTTP_CACHE_HEURISTIC_MAX;
+  }
+  return 0;
+}
+
+
+bool jbox_http_cache_is_fresh(const jbox_http_cache_entry_t *entry,
+                              time_t now) {
+  if (!entry->found) {
+    return false;
+  }
+  long lifetime = freshness_lifetime(entry->headers, entry->header_count,
+                                     entry->stored);
+  return now >= entry->stored && now - entry->stored < lifetime;
+}
+
+
+struct curl_slist *jbox_http_cache_conditional(
+    const jbox_http_cache_entry_t *entry, struct curl_slist *req_headers) {
+  static const char *const validators[][2] = {
+    { "ETag", "If-None-Match" },
+    { "Last-Modified", "If-Modified-Since" }
+  };
+
+  for (size_t i = 0; entry->found && i < 2; i++) {
+    const char *value = jbox_http_cache_header(
+        entry->headers, entry->header_count, validators[i][0]);
+    if (value == NULL) {
+      continue;
+    }
+    size_t len = strlen(validators[i][1]) + strlen(value) + 3;
+    char *line = malloc(len);
+    if (line != NULL) {
+      snprintf(line, len, "%s: %s", validators[i][1], value);
+      struct curl_slist *grown = curl_slist_append(req_headers, line);
+      if (grown != NULL) {
+        req_headers = grown;
+      }
+      free(line);
+    }
+  }
+  return req_headers;
+}
+
+
+FILE *jbox_http_cache_begin(jbox_http_cache_entry_t *entry) {
+  if (entry->tmp != NULL) {
+    return entry->tmp;
+  }
+  free(entry->tmp_path);
+  entry->tmp_path = slot_tmp_file(entry, ".body");
+  entry->tmp = entry->tmp_path ? fopen(entry->tmp_path, "wbe") : NULL;
+  return entry->tmp;
+}
+
+
+/**
+ * Tells whether a response may be stored.
+ * @param http_code Status of the response
+ * @param headers Header lines of the response
+ * @param count Number of lines
+ * @param now Current time
+ * @return true if it is worth storing
+ */
+static bool storable(long http_code, char *const *headers, size_t count,
+                     time_t now) {
+  if (http_code != 200) {
+    return false;
+  }
+
+  const char *cc = jbox_http_cache_header(headers, count, "Cache-Control");
+  if (cc != NULL && cache_directive(cc, "no-store", NULL)) {
+    return false;
+  }
+
+  // Bodies are stored decoded, so only Accept-Encoding may vary them
+  const char *vary = jbox_http_cache_header(headers, count, "Vary");
+  if (vary != NULL && vary[strspn(vary, " \t")] != '\0'
+      && strcasecmp(vary, "Accept-Encoding") != 0) {
+    return false;
+  }
+
+  return freshness_lifetime(headers, count, now) > 0
+         || jbox_http_cache_header(headers, count, "ETag") != NULL
+         || jbox_http_cache_header(headers, count, "Last-Modified") != NULL;
+}
+
+
+/**
+ * Writes a slot's .meta file under a temporary name and renames it into
+ * place.
+ * @param entry Located slot
+ * @param url Requested URL
+ * @param http_code Status of the response
+ * @param stored When the response was generated
+ * @param size Size of the body
+ * @param headers Header lines of the response
+ * @param count Number of lines
+ * @return 0 on success, -1 on error
+ */
+static int write_meta(const jbox_http_cache_entry_t *entry, const char *url,
+                      long http_code, time_t stored, size_t size,
+                      char *const *headers, size_t count) {
+  char *tmp_path = slot_tmp_file(entry, ".meta");
+  char *meta_path = slot_file(entry, ".meta");
+  FILE *f = tmp_path && meta_path ? fopen(tmp_path, "we") : NULL;
+  if (f == NULL) {
+    free(tmp_path);
+    free(meta_path);
+    return -1;
+  }
+
+  fprintf(f, "%s\n%ld %lld %zu\n%s\n", CACHE_MAGIC, http_code,
+          (long long)stored, size, url);
+  for (size_t i = 0; i < count; i++) {
+    if (headers[i] != NULL && strchr(headers[i], '\n') == NULL) {
+      fprintf(f, "%s\n", headers[i]);
+    }
+  }
+
+  int ret = fclose(f) == 0 && rename(tmp_path, meta_path) == 0 ? 0 : -1;
+  if (ret != 0) {
+    unlink(tmp_path);
+  }
+  free(tmp_path);
+  free(meta_path);
+  return ret;
+}
+
+
+/**
+ * Works out when a response was generated from its Age header.
+ * @param headers Header lines of the response
+ * @param count Number of lines
+ * @param now When it was received
+ * @return Generation time
+ */
+static time_t generated_at(char *const *headers, size_t count, time_t now) {
+  const char *age = jbox_http_cache_header(headers, count, "Age");
+  long seconds = age ? strtol(age, NULL, 10) : 0;
+  return seconds > 0 ? now - seconds : now;
+}
+
+
+int jbox_http_cache_commit(jbox_http_cache_entry_t *entry, const char *url,
+                           long http_code, char *const *headers,
+                           size_t count) {
+  if (entry->tmp == NULL) {
+    return -1;
+  }
+
+  time_t now = time(NULL);
+  long size = ftell(entry->tmp);
+  bool ok = fclose(entry->tmp) == 0 && size >= 0
+            && storable(http_code, headers, count, now);
+  entry->tmp = NULL;
+
+  char *body_path = ok ? slot_file(entry, ".body") : NULL;
+  ok = body_path != NULL && rename(entry->tmp_path, body_path) == 0
+       && write_meta(entry, url, http_code,
+                     generated_at(headers, count, now), (size_t)size,
+                     headers, count) == 0;
+  if (!ok) {
+    unlink(entry->tmp_path);
+  }
+  free(body_path);
+  free(entry->tmp_path);
+  entry->tmp_path = NULL;
+  return ok ? 0 : -1;
+}
+
+
+int jbox_http_cache_refresh(jbox_http_cache_entry_t *entry, const char *url,
+                            char *const *headers, size_t count) {
+  if (!entry->found) {
+    return -1;
+  }
+
+  // Stored headers the 304 does not replace, then the 304's own
+  size_t merged_count = 0;
+  char **merged = malloc((entry->header_count + count + 1) * sizeof(char *));
+  if (merged == NULL) {
+    return -1;
+  }
+  for (size_t i = 0; i < entry->header_count; i++) {
+    const char *colon = strchr(entry->headers[i], ':');
+    bool replaced = false;
+    for (size_t j = 0; colon && j < count && !replaced; j++) {
+      size_t len = (size_t)(colon - entry->headers[i]);
+      replaced = strncasecmp(headers[j], entry->headers[i], len) == 0
+                 && headers[j][len] == ':';
+    }
+    if (!replaced) {
+      merged[merged_count++] = entry->headers[i];
+    }
+  }
+  for (size_t j = 0; j < count; j++) {
+    if (strncasecmp(headers[j], "Content-Length:", 15) != 0) {
+      merged[merged_count++] = headers[j];
+    }
+  }
+
+  int ret = write_meta(entry, url, entry->http_code,
+                       generated_at(headers, count, time(NULL)),
+                       entry->body_size, merged, merged_count);
+  free(merged);
+  if (ret == 0) {
+    unload(entry);
+    load(entry, url);
+  }
+  return ret == 0 && entry->found ? 0 : -1;
+}
@@ -0,0 +1,134 @@
+#ifndef JBOX_HTTP_CACHE_H
+#define JBOX_HTTP_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+#include <curl/curl.h>
+
+/** Directory of the cache, under the home directory */
+#define JBOX_HTTP_CACHE_SUBPATH "/.jshell/http-cache"
+
+/** Longest a response is kept fresh on Last-Modified alone, in seconds */
+#define JBOX_HTTP_CACHE_HEURISTIC_MAX 86400
+
+/**
+ * A cache slot for one request, and the response stored in it if any.
+ *
+ * Each slot is a pair of files named after a hash of the URL and the
+ * request headers: <hash>.meta holds the status, the time the response
+ * was generated and its headers as text, and <hash>.body holds the
+ * decoded body, which is mapped rather than read when the entry is used.
+ */
+typedef struct {
+  char *path;                 /* Slot path without extension */
+  char *tmp_path;             /* Body being written, or NULL */
+  FILE *tmp;
+  bool found;                 /* A response is stored in the slot */
+  long http_code;
+  time_t stored;              /* When the response was generated */
+  char **headers;             /* "Name: value" lines of the response */
+  size_t header_count;
+  const char *body;           /* Mapped body, or NULL if empty */
+  size_t body_size;
+  char *meta;                 /* Storage behind url and headers */
+} jbox_http_cache_entry_t;
+
+/**
+ * Find the cache slot for a request and load what it holds.
+ *
+ * @param entry Filled in; free with jbox_http_cache_close() even on
+ *        failure
+ * @param url Requested URL
+ * @param req_headers Extra request headers, which are part of the key
+ * @return 0 if the slot could be located (entry->found tells whether a
+ *         response is stored), -1 if there is no usable cache directory
+ */
+int jbox_http_cache_open(jbox_http_cache_entry_t *entry, const char *url,
+                         const struct curl_slist *req_headers);
+
+/**
+ * Release what jbox_http_cache_open() loaded, dropping any body still
+ * being written.
+ *
+ * @param entry Entry to release
+ */
+void jbox_http_cache_close(jbox_http_cache_entry_t *entry);
+
+/**
+ * Find a header among "Name: value" lines, ignoring case in the name.
+ *
+ * @param headers Header lines
+ * @param count Number of lines
+ * @param name Header name
+ * @return The value of the last such header, or NULL
+ */
+const char *jbox_http_cache_header(char *const *headers, size_t count,
+                                   const char *name);
+
+/**
+ * Tell whether a stored response may be used without asking the server,
+ * going by Cache-Control, Expires and, failing those, a tenth of the
+ * time since Last-Modified.
+ *
+ * @param entry Entry holding a response
+ * @param now Current time
+ * @return true while the response is fresh
+ */
+bool jbox_http_cache_is_fresh(const jbox_http_cache_entry_t *entry,
+                              time_t now);
+
+/**
+ * Add If-None-Match and If-Modified-Since headers from a stored
+ * response's validators.
+ *
+ * @param entry Entry holding a response
+ * @param req_headers List to append to, or NULL
+ * @return The list, which may be new
+ */
+struct curl_slist *jbox_http_cache_conditional(
+    const jbox_http_cache_entry_t *entry, struct curl_slist *req_headers);
+
+/**
+ * Start writing a new body for the slot.
+ *
+ * @param entry Located slot
+ * @return Stream to write the body to, owned by the entry, or NULL on
+ *         error
+ */
+FILE *jbox_http_cache_begin(jbox_http_cache_entry_t *entry);
+
+/**
+ * Store the response whose body was written since
+ * jbox_http_cache_begin(), if it may be cached at all: a 200 without
+ * no-store or a Vary beyond Accept-Encoding, that is either fresh for a
+ * while or has a validator to revalidate it with. The body is dropped
+ * otherwise.
+ *
+ * @param entry Slot being written
+ * @param url Requested URL
+ * @param http_code Status of the response
+ * @param headers Header lines of the response, without the status line
+ * @param count Number of lines
+ * @return 0 if stored, -1 if not
+ */
+int jbox_http_cache_commit(jbox_http_cache_entry_t *entry, const char *url,
+                           long http_code, char *const *headers,
+                           size_t count);
+
+/**
+ * Update a stored response from a 304 Not Modified: the headers the
+ * server sent replace the stored ones of the same name, and the
+ * response counts as generated now.
+ *
+ * @param entry Entry holding a response
+ * @param url Requested URL
+ * @param headers Header lines of the 304, without the status line
+ * @param count Number of lines
+ * @return 0 on success, -1 on error
+ */
+int jbox_http_cache_refresh(jbox_http_cache_entry_t *entry, const char *url,
+                            char *const *headers, size_t count);
+
+#endif /* JBOX_HTTP_CACHE_H */
@@ -0,0 +1,1045 @@
+/**
+ * @file jbox_json.c
+ * @brief Dependency-free streaming JSON reader and writer.
+ *
+ * The reader is a pull tokenizer: each jbox_json_next() call returns the
+ * next event (object/array boundaries, keys and scalars) and validates
+ * the grammar as it goes, so callers walk a document in one pass and keep
+ * only what they need. Values a caller skips, and values a stream is cut
+ * into, are not tokenized at all: a structural scan finds their end by
+ * looking only at quotes, backslashes and brackets, eight bytes per step.
+ * The writer escapes straight to a FILE*, so output of any size needs no
+ * intermediate escape buffer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "jbox_json.h"
+
+
+/** Eight copies of a byte value */
+#define BYTES8(b) (0x0101010101010101ULL * (uint64_t)(b))
+
+
+/** Reader states between events. */
+enum {
+  JSON_ST_VALUE,          /**< A value must follow */
+  JSON_ST_VALUE_OR_END,   /**< Just after '[' */
+  JSON_ST_KEY_OR_END,     /**< Just after '{' */
+  JSON_ST_KEY,            /**< After ',' in an object */
+  JSON_ST_AFTER_VALUE,    /**< After a complete value */
+  JSON_ST_DONE,
+  JSON_ST_ERROR,
+};
+
+
+// ---------------------------------------------------------------------------
+// Reader
+// ---------------------------------------------------------------------------
+
+/**
+ * @brief Initializes a reader over a buffer.
+ *
+ * @param r Reader to initialize
+ * @param json Document text
+ * @param len Length of json in bytes
+ */
+void jbox_json_reader_init(jbox_json_reader_t *r, const char *json,
+                           size_t len) {
+  memset(r, 0, sizeof(*r));
+  r->pos = json;
+  r->end = json + len;
+  r->state = JSON_ST_VALUE;
+}
+
+
+/**
+ * @brief Frees the reader's text buffer.
+ *
+ * @param r Reader to clean up
+ */
+void jbox_json_reader_free(jbox_json_reader_t *r) {
+  free(r->text);
+  r->text = NULL;
+  r->text_len = 0;
+  r->text_cap = 0;
+}
+
+
+/**
+ * @brief Puts the reader into the error state.
+ *
+ * @param r Reader
+ * @return JBOX_JSON_ERROR
+ */
+static jbox_json_event_t reader_fail(jbox_json_reader_t *r) {
+  r->state = JSON_ST_ERROR;
+  return JBOX_JSON_ERROR;
+}
+
+
+/**
+ * @brief Skips JSON whitespace.
+ *
+ * @param r Reader
+ */
+static void skip_ws(jbox_json_reader_t *r) {
+  while (r->pos < r->end && (*r->pos == ' ' || *r->pos == '\t'
+                             || *r->pos == '\n' || *r->pos == '\r')) {
+    r->pos++;
+  }
+}
+
+
+/**
+ * @brief Makes room for more bytes in the text buffer.
+ *
+ * @param r Reader
+ * @param extra Bytes to be appended (the NUL is accounted for here)
+ * @return true on success, false if memory ran out
+ */
+static bool text_reserve(jbox_json_reader_t *r, size_t extra) {
+  if (r->text_len + extra < r->text_cap) {
+    return true;
+  }
+  size_t cap = r->text_cap == 0 ? 64 : r->text_cap;
+  while (cap <= r->text_len + extra) {
+    cap *= 2;
+  }
+  char *text = realloc(r->text, cap);
+  if (text == NULL) {
+    return false;
+  }
+  r->text = text;
+  r->text_cap = cap;
+  return true;
+}
+
+
+/**
+ * @brief Parses four hex digits of a \\u escape.
+ *
+ * @param p First digit (at least four bytes must be readable)
+ * @param value Set to the code unit
+ * @return true if all four digits are valid
+ */
+static bool parse_hex4(const char *p, unsigned *value) {
+  unsigned v = 0;
+  for (int i = 0; i < 4; i++) {
+    char c = p[i];
+    v <<= 4;
+    if (c >= '0' && c <= '9') {
+      v |= (unsigned)(c - '0');
+    } else if (c >= 'a' && c <= 'f') {
+      v |= (unsigned)(c - 'a' + 10);
+    } else if (c >= 'A' && c <= 'F') {
+      v |= (unsigned)(c - 'A' + 10);
+    } else {
+      return false;
+    }
+  }
+  *value = v;
+  return true;
+}
+
+
+/**
+ * @brief Appends a code point to the text buffer as UTF-8.
+ *
+ * @param r Reader with at least four bytes reserved
+ * @param cp Code point
+ */
+static void text_put_utf8(jbox_json_reader_t *r, unsigned cp) {
+  char *out = r->text + r->text_len;
+  if (cp < 0x80) {
+    out[0] = (char)cp;
+    r->text_len += 1;
+  } else if (cp < 0x800) {
+    out[0] = (char)(0xC0 | (cp >> 6));
+    out[1] = (char)(0x80 | (cp & 0x3F));
+    r->text_len += 2;
+  } else if (cp < 0x10000) {
+    out[0] = (char)(0xE0 | (cp >> 12));
+    out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[2] = (char)(0x80 | (cp & 0x3F));
+    r->text_len += 3;
+  } else {
+    out[0] = (char)(0xF0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    r->text_len += 4;
+  }
+}
+
+
+/**
+ * @brief Decodes the string at the current position into the text buffer.
+ *
+ * Raw control characters are tolerated, since older jbox writers emitted
+ * them unescaped.
+ *
+ * @param r Reader positioned on the opening quote
+ * @return true on success, false if the string is malformed
+ */
+static bool read_string_token(jbox_json_reader_t *r) {
+  r->pos++;  // Opening quote
+  r->text_len = 0;
+
+  while (r->pos < r->end && *r->pos != '"') {
+    // Copy the run up to the next quote or escape in one go
+    const char *run = r->pos;
+    while (r->pos < r->end && *r->pos != '"' && *r->pos != '\\') {
+      r->pos++;
+    }
+    size_t run_len = (size_t)(r->pos - run);
+    if (run_len > 0) {
+      if (!text_reserve(r, run_len)) {
+        return false;
+      }
+      memcpy(r->text + r->text_len, run, run_len);
+      r->text_len += run_len;
+    }
+    if (r->pos >= r->end || *r->pos == '"') {
+      break;
+    }
+
+    // Escape sequence
+    if (r->end - r->pos < 2 || !text_reserve(r, 4)) {
+      return false;
+    }
+    char c = r->pos[1];
+    r->pos += 2;
+    switch (c) {
+      case '"':  r->text[r->text_len++] = '"'; break;
+      case '\\': r->text[r->text_len++] = '\\'; break;
+      case '/':  r->text[r->text_len++] = '/'; break;
+      case 'b':  r->text[r->text_len++] = '\b'; break;
+      case 'f':  r->text[r->text_len++] = '\f'; break;
+      case 'n':  r->text[r->text_len++] = '\n'; break;
+      case 'r':  r->text[r->text_len++] = '\r'; break;
+      case 't':  r->text[r->text_len++] = '\t'; break;
+      case 'u': {
+        unsigned cp;
+        if (r->end - r->pos < 4 || !parse_hex4(r->pos, &cp)) {
+          return false;
+        }
+        r->pos += 4;
+        if (cp >= 0xD800 && cp < 0xDC00 && r->end - r->pos >= 6
+            && r->pos[0] == '\\' && r->pos[1] == 'u') {
+          unsigned low;
+          if (parse_hex4(r->pos + 2, &low) && low >= 0xDC00 && low < 0xE000) {
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+            r->pos += 6;
+          }
+        }
+        text_put_utf8(r, cp);
+        break;
+      }
+      default:
+        return false;
+    }
+  }
+
+  if (r->pos >= r->end || !text_reserve(r, 0)) {
+    return false;
+  }
+  r->pos++;  // Closing quote
+  r->text[r->text_len] = '\0';
+  return true;
+}
+
+
+/**
+ * @brief Scans a run of decimal digits.
+ *
+ * @param r Reader
+ * @return Number of digits consumed
+ */
+static size_t scan_digits(jbox_json_reader_t *r) {
+  const char *start = r->pos;
+  while (r->pos < r->end && *r->pos >= '0' && *r->pos <= '9') {
+    r->pos++;
+  }
+  return (size_t)(r->pos - start);
+}
+
+
+/**
+ * @brief Validates the number at the current position and copies it into
+ *        the text buffer.
+ *
+ * @param r Reader positioned on '-' or a digit
+ * @return true on success, false if the number is malformed
+ */
+static bool read_number_token(jbox_json_reader_t *r) {
+  const char *start = r->pos;
+
+  if (*r->pos == '-') {
+    r->pos++;
+  }
+  if (r->pos < r->end && *r->pos == '0') {
+    r->pos++;
+  } else if (scan_digits(r) == 0) {
+    return false;
+  }
+  if (r->pos < r->end && *r->pos == '.') {
+    r->pos++;
+    if (scan_digits(r) == 0) {
+      return false;
+    }
+  }
+  if (r->pos < r->end && (*r->pos == 'e' || *r->pos == 'E')) {
+    r->pos++;
+    if (r->pos < r->end && (*r->pos == '+' || *r->pos == '-')) {
+      r->pos++;
+    }
+    if (scan_digits(r) == 0) {
+      return false;
+    }
+  }
+
+  size_t len = (size_t)(r->pos - start);
+  r->text_len = 0;
+  if (!text_reserve(r, len)) {
+    return false;
+  }
+  memcpy(r->text, start, len);
+  r->text_len = len;
+  r->text[len] = '\0';
+  return true;
+}
+
+
+/**
+ * @brief Matches a literal keyword at the current position.
+ *
+ * @param r Reader
+ * @param word Keyword (true, false or null)
+ * @return true if it matched and was consumed
+ */
+static bool read_literal(jbox_json_reader_t *r, const char *word) {
+  size_t len = strlen(word);
+  if ((size_t)(r->end - r->pos) < len || memcmp(r->pos, word, len) != 0) {
+    return false;
+  }
+  r->pos += len;
+  return true;
+}
+
+
+/**
+ * @brief Reads the value starting at the current position.
+ *
+ * @param r Reader expecting a value
+ * @return Event for the value
+ */
+static jbox_json_event_t read_value(jbox_json_reader_t *r) {
+  if (r->pos >= r->end) {
+    return reader_fail(r);
+  }
+
+  char c = *r->pos;
+  if (c == '{' || c == '[') {
+    if (r->depth >= JBOX_JSON_MAX_DEPTH) {
+      return reader_fail(r);
+    }
+    r->stack[r->depth++] = c;
+    r->pos++;
+    if (c == '{') {
+      r->state = JSON_ST_KEY_OR_END;
+      return JBOX_JSON_OBJECT_BEGIN;
+    }
+    r->state = JSON_ST_VALUE_OR_END;
+    return JBOX_JSON_ARRAY_BEGIN;
+  }
+
+  jbox_json_event_t ev;
+  if (c == '"') {
+    if (!read_string_token(r)) {
+      return reader_fail(r);
+    }
+    ev = JBOX_JSON_STRING;
+  } else if (c == '-' || (c >= '0' && c <= '9')) {
+    if (!read_number_token(r)) {
+      return reader_fail(r);
+    }
+    ev = JBOX_JSON_NUMBER;
+  } else if (read_literal(r, "true")) {
+    ev = JBOX_JSON_TRUE;
+  } else if (read_literal(r, "false")) {
+    ev = JBOX_JSON_FALSE;
+  } else if (read_literal(r, "null")) {
+    ev = JBOX_JSON_NULL;
+  } else {
+    return reader_fail(r);
+  }
+
+  r->state = JSON_ST_AFTER_VALUE;
+  return ev;
+}
+
+
+/**
+ * @brief Closes the innermost container.
+ *
+ * @param r Reader positioned on the closing bracket
+ * @return OBJECT_END or ARRAY_END
+ */
+static jbox_json_event_t close_container(jbox_json_reader_t *r) {
+  r->pos++;
+  r->state = JSON_ST_AFTER_VALUE;
+  return r->stack[--r->depth] == '{' ? JBOX_JSON_OBJECT_END
+                                     : JBOX_JSON_ARRAY_END;
+}
+
+
+/**
+ * @brief Reads the next event.
+ *
+ * @param r Reader
+ * @return Next event
+ */
+jbox_json_event_t jbox_json_next(jbox_json_reader_t *r) {
+  if (r->state == JSON_ST_ERROR) {
+    return JBOX_JSON_ERROR;
+  }
+  if (r->state == JSON_ST_DONE) {
+    return JBOX_JSON_DONE;
+  }
+
+  skip_ws(r);
+
+  if (r->state == JSON_ST_AFTER_VALUE) {
+    if (r->depth == 0) {
+      if (r->pos != r->end) {
+        return reader_fail(r);  // Trailing garbage
+      }
+      r->state = JSON_ST_DONE;
+      return JBOX_JSON_DONE;
+    }
+    if (r->pos >= r->end) {
+      return reader_fail(r);
+    }
+
+    char top = r->stack[r->depth - 1];
+    char c = *r->pos;
+    if ((c == '}' && top == '{') || (c == ']' && top == '[')) {
+      return close_container(r);
+    }
+    if (c != ',') {
+      return reader_fail(r);
+    }
+    r->pos++;
+    skip_ws(r);
+    r->state = top == '{' ? JSON_ST_KEY : JSON_ST_VALUE;
+  }
+
+  if (r->state == JSON_ST_KEY_OR_END || r->state == JSON_ST_VALUE_OR_END) {
+    char close = r->state == JSON_ST_KEY_OR_END ? '}' : ']';
+    if (r->pos < r->end && *r->pos == close) {
+      return close_container(r);
+    }
+    r->state = r->state == JSON_ST_KEY_OR_END ? JSON_ST_KEY : JSON_ST_VALUE;
+  }
+
+  if (r->state == JSON_ST_KEY) {
+    if (r->pos >= r->end || *r->pos != '"' || !read_string_token(r)) {
+      return reader_fail(r);
+    }
+    skip_ws(r);
+    if (r->pos >= r->end || *r->pos != ':') {
+      return reader_fail(r);
+    }
+    r->pos++;
+    skip_ws(r);
+    r->state = JSON_ST_VALUE;
+    return JBOX_JSON_KEY;
+  }
+
+  return read_value(r);
+}
+
+
+// ---------------------------------------------------------------------------
+// Structural scan
+// ---------------------------------------------------------------------------
+
+/**
+ * @brief Marks the bytes of a word equal to those of a pattern.
+ *
+ * Exact (no borrow between bytes), so the lowest set bit is the first
+ * match.
+ *
+ * @param word Eight bytes, the first in the low byte
+ * @param pattern Eight copies of the byte to look for
+ * @return Top bit set in each matching byte
+ */
+static inline uint64_t bytes_equal(uint64_t word, uint64_t pattern) {
+  const uint64_t low7 = BYTES8(0x7f);
+  uint64_t x = word ^ pattern;
+  return ~(((x & low7) + low7) | x | low7);
+}
+
+
+/**
+ * @brief Finds the next byte that matters to the structure.
+ *
+ * Inside a string that is '"' or '\\'. Outside, it is '"' or a bracket:
+ * clearing bit 5 maps '{' onto '[' and '}' onto ']', and nothing else
+ * onto either, so two compares cover all four brackets.
+ *
+ * @param p Start
+ * @param end End
+ * @param in_string Whether p is inside a string
+ * @return Pointer to the byte, or end
+ */
+static const char *find_structural(const char *p, const char *end,
+                                   bool in_string) {
+  const uint64_t quote = BYTES8('"');
+  const uint64_t backslash = BYTES8('\\');
+  const uint64_t open = BYTES8('[');
+  const uint64_t close = BYTES8(']');
+  const uint64_t fold = BYTES8(0xdf);
+
+  while (end - p >= 8) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);   // Byte 0 lowest
+#endif
+    uint64_t hit = bytes_equal(word, quote);
+    if (in_string) {
+      hit |= bytes_equal(word, backslash);
+    } else {
+      uint64_t folded = word & fold;
+      hit |= bytes_equal(folded, open) | bytes_equal(folded, close);
+    }
+    if (hit) {
+      return p + (__builtin_ctzll(hit) >> 3);
+    }
+    p += 8;
+  }
+  for (; p < end; p++) {
+    char c = *p;
+    if (c == '"' || (in_string ? c == '\\'
+                               : ((c & 0xdf) == '[' || (c & 0xdf) == ']'))) {
+      return p;
+    }
+  }
+  return end;
+}
+
+
+/**
+ * @brief Scans until the brackets open at the start are all closed.
+ *
+ * @param pos Scan position; advanced to after the closing bracket, or to
+ *        where the scan can resume
+ * @param end End of the data
+ * @param depth Brackets open; updated
+ * @param in_string Whether *pos is inside a string; updated
+ * @return true once depth reaches 0, false if the data ends first
+ */
+static bool scan_brackets(const char **pos, const char *end, int *depth,
+                          bool *in_string) {
+  const char *p = *pos;
+  for (;;) {
+    const char *q = find_structural(p, end, *in_string);
+    if (q == end) {
+      *pos = end;
+      return false;
+    }
+    if (*in_string) {
+      if (*q == '\\') {
+        if (end - q < 2) {
+          *pos = q;  // Resume at the backslash once its pair is read
+          return false;
+        }
+        p = q + 2;
+        continue;
+      }
+      *in_string = false;
+      p = q + 1;
+      if (*depth == 0) {
+        *pos = p;
+        return true;
+      }
+      continue;
+    }
+    p = q + 1;
+    if (*q == '"') {
+      *in_string = true;
+    } else if ((*q & 0xdf) == '[') {
+      (*depth)++;
+    } else if (--*depth == 0) {
+      *pos = p;
+      return true;
+    }
+  }
+}
+
+
+/**
+ * @brief Finds where the value at the start of data ends.
+ *
+ * @param scan Progress
+ * @param data Value text
+ * @param len Bytes available
+ * @param at_end Whether no more data follows
+ * @return 1 when complete, 0 if more data is needed, -1 if truncated
+ */
+int jbox_json_scan(jbox_json_scan_t *scan, const char *data, size_t len,
+                   bool at_end) {
+  const char *end = data + len;
+  if (scan->off == 0 && !scan->in_string && scan->depth == 0) {
+    if (len == 0) {
+      return at_end ? -1 : 0;
+    }
+    if (data[0] == '{' || data[0] == '[') {
+      scan->depth = 1;
+      scan->off = 1;
+    } else if (data[0] == '"') {
+      scan->in_string = true;
+      scan->off = 1;
+    } else {
+      // Number or literal: it ends where a separator does
+      const char *p = data;
+      while (p < end && !strchr(" \t\r\n,]}", *p)) {
+        p++;
+      }
+      if (p == end && !at_end) {
+        return 0;
+      }
+      scan->off = (size_t)(p - data);
+      return 1;
+    }
+  }
+
+  const char *pos = data + scan->off;
+  bool done = scan_brackets(&pos, end, &scan->depth, &scan->in_string);
+  scan->off = (size_t)(pos - data);
+  if (done) {
+    return 1;
+  }
+  return at_end ? -1 : 0;
+}
+
+
+/**
+ * @brief Skips the remainder of a value without decoding it.
+ *
+ * @param r Reader
+ * @param ev Event that started the value
+ * @return 0 on success, -1 on malformed input
+ */
+int jbox_json_skip(jbox_json_reader_t *r, jbox_json_event_t ev) {
+  if (ev == JBOX_JSON_ERROR) {
+    return -1;
+  }
+  if (ev != JBOX_JSON_OBJECT_BEGIN && ev != JBOX_JSON_ARRAY_BEGIN) {
+    return 0;
+  }
+
+  int depth = 1;
+  bool in_string = false;
+  if (!scan_brackets(&r->pos, r->end, &depth, &in_string)) {
+    reader_fail(r);
+    return -1;
+  }
+  r->depth--;
+  r->state = JSON_ST_AFTER_VALUE;
+  return 0;
+}
+
+
+/**
+ * @brief Advances to a member of the current object.
+ *
+ * @param r Reader
+ * @param key Member name
+ * @return true if the member was found
+ */
+bool jbox_json_find_key(jbox_json_reader_t *r, const char *key) {
+  for (;;) {
+    jbox_json_event_t ev = jbox_json_next(r);
+    if (ev != JBOX_JSON_KEY) {
+      return false;
+    }
+    if (strcmp(r->text, key) == 0) {
+      return true;
+    }
+    if (jbox_json_skip(r, jbox_json_next(r)) != 0) {
+      return false;
+    }
+  }
+}
+
+
+/**
+ * @brief Reads a string value into newly allocated memory.
+ *
+ * @param r Reader
+ * @return Decoded string, or NULL
+ */
+char *jbox_json_read_string(jbox_json_reader_t *r) {
+  jbox_json_event_t ev = jbox_json_next(r);
+  if (ev != JBOX_JSON_STRING) {
+    jbox_json_skip(r, ev);
+    return NULL;
+  }
+
+  char *str = malloc(r->text_len + 1);
+  if (str != NULL) {
+    memcpy(str, r->text, r->text_len + 1);
+  }
+  return str;
+}
+
+
+/**
+ * @brief Reads an array of strings.
+ *
+ * @param r Reader
+ * @param count Set to the number of strings
+ * @return Array of strings, or NULL if empty
+ */
+char **jbox_json_read_string_array(jbox_json_reader_t *r, int *count) {
+  *count = 0;
+
+  jbox_json_event_t ev = jbox_json_next(r);
+  if (ev != JBOX_JSON_ARRAY_BEGIN) {
+    jbox_json_skip(r, ev);
+    return NULL;
+  }
+
+  char **items = NULL;
+  int capacity = 0;
+  while ((ev = jbox_json_next(r)) != JBOX_JSON_ARRAY_END) {
+    if (ev != JBOX_JSON_STRING) {
+      if (jbox_json_skip(r, ev) != 0) {
+        break;
+      }
+      continue;
+    }
+
+    if (*count >= capacity) {
+      capacity = capacity == 0 ? 4 : capacity * 2;
+      char **new_items = realloc(items, (size_t)capacity * sizeof(char *));
+      if (new_items == NULL) {
+        break;
+      }
+      items = new_items;
+    }
+    char *item = malloc(r->text_len + 1);
+    if (item == NULL) {
+      break;
+    }
+    memcpy(item, r->text, r->text_len + 1);
+    items[(*count)++] = item;
+  }
+
+  if (*count == 0) {
+    free(items);
+    return NULL;
+  }
+  return items;
+}
+
+
+/**
+ * @brief Reads an integer value.
+ *
+ * @param r Reader
+ * @param value Set to the number
+ * @return true if the value was a number
+ */
+bool jbox_json_read_int(jbox_json_reader_t *r, long long *value) {
+  jbox_json_event_t ev = jbox_json_next(r);
+  if (ev != JBOX_JSON_NUMBER) {
+    jbox_json_skip(r, ev);
+    return false;
+  }
+
+  if (strpbrk(r->text, ".eE") != NULL) {
+    *value = (long long)strtod(r->text, NULL);
+  } else {
+    *value = strtoll(r->text, NULL, 10);
+  }
+  return true;
+}
+
+
+// ---------------------------------------------------------------------------
+// Writer
+// ---------------------------------------------------------------------------
+
+/**
+ * @brief Writes bytes escaped for a JSON string body.
+ *
+ * Runs of characters that need no escaping are written with one fwrite.
+ *
+ * @param out Output stream
+ * @param str Data
+ * @param len Length in bytes
+ */
+void jbox_json_write_escaped(FILE *out, const char *str, size_t len) {
+  size_t run = 0;
+  for (size_t i = 0; i < len; i++) {
+    unsigned char c = (unsigned char)str[i];
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+
+    if (i > run) {
+      fwrite(str + run, 1, i - run, out);
+    }
+    run = i + 1;
+
+    switch (c) {
+      case '"':  fputs("\\\"", out); break;
+      case '\\': fputs("\\\\", out); break;
+      case '\b': fputs("\\b", out); break;
+      case '\f': fputs("\\f", out); break;
+      case '\n': fputs("\\n", out); break;
+      case '\r': fputs("\\r", out); break;
+      case '\t': fputs("\\t", out); break;
+      default:   fprintf(out, "\\u%04x", c); break;
+    }
+  }
+  if (len > run) {
+    fwrite(str + run, 1, len - run, out);
+  }
+}
+
+
+/**
+ * @brief Writes bytes as a quoted JSON string.
+ *
+ * @param out Output stream
+ * @param str Data
+ * @param len Length in bytes
+ */
+void jbox_json_write_string_n(FILE *out, const char *str, size_t len) {
+  fputc('"', out);
+  if (str != NULL) {
+    jbox_json_write_escaped(out, str, len);
+  }
+  fputc('"', out);
+}
+
+
+/**
+ * @brief Writes a C string as a quoted JSON string.
+ *
+ * @param out Output stream
+ * @param str String, or NULL for ""
+ */
+void jbox_json_write_string(FILE *out, const char *str) {
+  jbox_json_write_string_n(out, str, str != NULL ? strlen(str) : 0);
+}
+
+
+/**
+ * @brief Initializes a writer.
+ *
+ * @param w Writer
+ * @param out Output stream
+ * @param pretty true for indented output
+ */
+void jbox_json_writer_init(jbox_json_writer_t *w, FILE *out, bool pretty) {
+  memset(w, 0, sizeof(*w));
+  w->out = out;
+  w->pretty = pretty;
+}
+
+
+/**
+ * @brief Starts a new line at the current indentation.
+ *
+ * @param w Writer
+ */
+static void write_indent(jbox_json_writer_t *w) {
+  fputc('\n', w->out);
+  for (int i = 0; i < w->depth; i++) {
+    fputs("  ", w->out);
+  }
+}
+
+
+/**
+ * @brief Writes the separator due before a value or member.
+ *
+ * @param w Writer
+ */
+static void begin_item(jbox_json_writer_t *w) {
+  if (w->after_key) {
+    w->after_key = false;
+    return;
+  }
+  if (w->depth == 0 || w->depth > JBOX_JSON_MAX_DEPTH) {
+    return;
+  }
+
+  bool *has_items = &w->has_items[w->depth - 1];
+  if (*has_items) {
+    fputs(w->pretty ? "," : ", ", w->out);
+  }
+  *has_items = true;
+  if (w->pretty) {
+    write_indent(w);
+  }
+}
+
+
+/**
+ * @brief Opens a container.
+ *
+ * @param w Writer
+ * @param open Opening bracket
+ */
+static void open_container(jbox_json_writer_t *w, char open) {
+  begin_item(w);
+  fputc(open, w->out);
+  if (w->depth < JBOX_JSON_MAX_DEPTH) {
+    w->has_items[w->depth] = false;
+  }
+  w->depth++;
+}
+
+
+/**
+ * @brief Closes a container.
+ *
+ * @param w Writer
+ * @param close Closing bracket
+ */
+static void close_container_out(jbox_json_writer_t *w, char close) {
+  if (w->depth == 0) {
+    return;
+  }
+  w->depth--;
+  if (w->pretty && w->depth < JBOX_JSON_MAX_DEPTH
+      && w->has_items[w->depth]) {
+    write_indent(w);
+  }
+  fputc(close, w->out);
+}
+
+
+/** @brief Opens an object. @param w Writer */
+void jbox_json_begin_object(jbox_json_writer_t *w) {
+  open_container(w, '{');
+}
+
+
+/** @brief Closes an object. @param w Writer */
+void jbox_json_end_object(jbox_json_writer_t *w) {
+  close_container_out(w, '}');
+}
+
+
+/** @brief Opens an array. @param w Writer */
+void jbox_json_begin_array(jbox_json_writer_t *w) {
+  open_container(w, '[');
+}
+
+
+/** @brief Closes an array. @param w Writer */
+void jbox_json_end_array(jbox_json_writer_t *w) {
+  close_container_out(w, ']');
+}
+
+
+/**
+ * @brief Writes a member name.
+ *
+ * @param w Writer
+ * @param key Member name
+ */
+void jbox_json_key(jbox_json_writer_t *w, const char *key) {
+  begin_item(w);
+  jbox_json_write_string(w->out, key);
+  fputs(": ", w->out);
+  w->after_key = true;
+}
+
+
+/**
+ * @brief Writes a string value.
+ *
+ * @param w Writer
+ * @param str String, or NULL for null
+ */
+void jbox_json_string(jbox_json_writer_t *w, const char *str) {
+  if (str == NULL) {
+    jbox_json_null(w);
+    return;
+  }
+  begin_item(w);
+  jbox_json_write_string(w->out, str);
+}
+
+
+/**
+ * @brief Writes a string value from raw bytes.
+ *
+ * @param w Writer
+ * @param str Data
+ * @param len Length in bytes
+ */
+void jbox_json_string_n(jbox_json_writer_t *w, const char *str, size_t len) {
+  begin_item(w);
+  jbox_json_write_string_n(w->out, str, len);
+}
+
+
+/**
+ * @brief Writes an integer value.
+ *
+ * @param w Writer
+ * @param value Number
+ */
+void jbox_json_int(jbox_json_writer_t *w, long long value) {
+  begin_item(w);
+  fprintf(w->out, "%lld", value);
+}
+
+
+/**
+ * @brief Writes a boolean value.
+ *
+ * @param w Writer
+ * @param value Boolean
+ */
+void jbox_json_bool(jbox_json_writer_t *w, bool value) {
+  begin_item(w);
+  fputs(value ? "true" : "false", w->out);
+}
+
+
+/**
+ * @brief Writes null.
+ *
+ * @param w Writer
+ */
+void jbox_json_null(jbox_json_writer_t *w) {
+  begin_item(w);
+  fputs("null", w->out);
+}
+
+
+/**
+ * @brief Writes pre-encoded JSON text as a value.
+ *
+ * @param w Writer
+ * @param json JSON text
+ */
+void jbox_json_raw(jbox_json_writer_t *w, const char *json) {
+  begin_item(w);
+  fputs(json, w->out);
+}
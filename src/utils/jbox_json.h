@@ -0,0 +1,291 @@
+#ifndef JBOX_JSON_H
+#define JBOX_JSON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/** Deepest object/array nesting the reader and writer track. */
+#define JBOX_JSON_MAX_DEPTH 64
+
+
+/**
+ * Events produced by the reader, one per call to jbox_json_next().
+ */
+typedef enum {
+  JBOX_JSON_ERROR = -1,     /**< Malformed input; the reader stays here */
+  JBOX_JSON_DONE = 0,       /**< The top-level value is complete */
+  JBOX_JSON_OBJECT_BEGIN,
+  JBOX_JSON_OBJECT_END,
+  JBOX_JSON_ARRAY_BEGIN,
+  JBOX_JSON_ARRAY_END,
+  JBOX_JSON_KEY,            /**< Object member name, decoded into text */
+  JBOX_JSON_STRING,         /**< String value, decoded into text */
+  JBOX_JSON_NUMBER,         /**< Number, its source text copied into text */
+  JBOX_JSON_TRUE,
+  JBOX_JSON_FALSE,
+  JBOX_JSON_NULL,
+} jbox_json_event_t;
+
+
+/**
+ * Streaming JSON reader.
+ *
+ * Walks a buffer one event at a time (SAX style, pulled rather than
+ * pushed) without building a tree, so callers keep only the fields they
+ * want. The text of the latest KEY, STRING or NUMBER event is in text
+ * (NUL-terminated; text_len excludes the NUL and embedded NULs from
+ * \u0000 are kept) and is valid until the next call.
+ */
+typedef struct {
+  const char *pos;
+  const char *end;
+  char stack[JBOX_JSON_MAX_DEPTH];  /**< '{' or '[' per open container */
+  int depth;
+  int state;
+  char *text;
+  size_t text_len;
+  size_t text_cap;
+} jbox_json_reader_t;
+
+
+/**
+ * Streaming JSON writer.
+ *
+ * Writes straight to a FILE*, escaping strings as they are written and
+ * inserting separators itself. With pretty set, members and elements go
+ * on their own lines indented by two spaces per level.
+ */
+typedef struct {
+  FILE *out;
+  bool pretty;
+  int depth;
+  bool has_items[JBOX_JSON_MAX_DEPTH];
+  bool after_key;
+} jbox_json_writer_t;
+
+
+/**
+ * Start reading a JSON document.
+ *
+ * @param r Reader to initialize
+ * @param json Document text (need not be NUL-terminated)
+ * @param len Length of json in bytes
+ */
+void jbox_json_reader_init(jbox_json_reader_t *r, const char *json,
+                           size_t len);
+
+/**
+ * Release the reader's text buffer.
+ *
+ * @param r Reader to clean up
+ */
+void jbox_json_reader_free(jbox_json_reader_t *r);
+
+/**
+ * Read the next event.
+ *
+ * @param r Reader
+ * @return Next event; JBOX_JSON_DONE once the document is complete, or
+ *         JBOX_JSON_ERROR (repeatedly) if it is malformed
+ */
+jbox_json_event_t jbox_json_next(jbox_json_reader_t *r);
+
+/**
+ * Skip the rest of a value whose first event has just been read.
+ *
+ * For OBJECT_BEGIN/ARRAY_BEGIN this consumes through the matching end;
+ * for scalars it does nothing. The skipped text is not decoded: only
+ * strings and brackets are found (see jbox_json_scan()), so it is checked
+ * for balance but not for grammar.
+ *
+ * @param r Reader
+ * @param ev Event that started the value
+ * @return 0 on success, -1 if the input is malformed
+ */
+int jbox_json_skip(jbox_json_reader_t *r, jbox_json_event_t ev);
+
+
+/**
+ * Progress of jbox_json_scan() through one value; zero it to start.
+ */
+typedef struct {
+  size_t off;           /**< Bytes of the value scanned so far */
+  int depth;            /**< Brackets open at off */
+  bool in_string;       /**< Whether off is inside a string */
+} jbox_json_scan_t;
+
+/**
+ * Find where the JSON value at the start of data ends, for splitting a
+ * stream into values (NDJSON, or the elements of a large array) before
+ * they are read. Only quotes, backslashes and brackets are looked at,
+ * eight bytes per step, so nothing is decoded.
+ *
+ * The scan resumes where it stopped: when data ends first, call again
+ * with the same value's data extended by whatever has been read since.
+ *
+ * @param scan Progress, zeroed before the first call for a value
+ * @param data Text starting with the value's first byte
+ * @param len Bytes of data available
+ * @param at_end Whether no more data follows
+ * @return 1 once the value is complete, its length in scan->off; 0 if
+ *         more data is needed; -1 if the data ends inside the value and
+ *         at_end is set
+ */
+int jbox_json_scan(jbox_json_scan_t *scan, const char *data, size_t len,
+                   bool at_end);
+
+/**
+ * Advance to a member of the object being read.
+ *
+ * Call after OBJECT_BEGIN (or after a member's value). Other members are
+ * skipped; on success the next event is the member's value.
+ *
+ * @param r Reader
+ * @param key Member name to look for
+ * @return true if found, false at the end of the object or on error
+ */
+bool jbox_json_find_key(jbox_json_reader_t *r, const char *key);
+
+/**
+ * Read a string value.
+ *
+ * A value of any other type is skipped.
+ *
+ * @param r Reader
+ * @return Newly allocated decoded string, or NULL if the value is not a
+ *         string or memory ran out. Caller must free.
+ */
+char *jbox_json_read_string(jbox_json_reader_t *r);
+
+/**
+ * Read a string array.
+ *
+ * Non-string elements are skipped; a value that is not an array yields
+ * an empty result.
+ *
+ * @param r Reader
+ * @param count Set to the number of strings returned
+ * @return Newly allocated array of newly allocated strings, or NULL if
+ *         there are none. Caller must free each string and the array.
+ */
+char **jbox_json_read_string_array(jbox_json_reader_t *r, int *count);
+
+/**
+ * Read an integer value.
+ *
+ * @param r Reader
+ * @param value Set to the number, truncated toward zero
+ * @return true if the value was a number, false otherwise (and skipped)
+ */
+bool jbox_json_read_int(jbox_json_reader_t *r, long long *value);
+
+
+/**
+ * Write bytes escaped for use inside a JSON string, without quotes.
+ *
+ * Lets large data be written in pieces, e.g. a file read in chunks.
+ *
+ * @param out Output stream
+ * @param str Data to escape
+ * @param len Length of str in bytes
+ */
+void jbox_json_write_escaped(FILE *out, const char *str, size_t len);
+
+/**
+ * Write bytes as a quoted JSON string literal.
+ *
+ * @param out Output stream
+ * @param str Data to write (may be NULL if len is 0)
+ * @param len Length of str in bytes
+ */
+void jbox_json_write_string_n(FILE *out, const char *str, size_t len);
+
+/**
+ * Write a C string as a quoted JSON string literal.
+ *
+ * @param out Output stream
+ * @param str String to write (NULL writes "")
+ */
+void jbox_json_write_string(FILE *out, const char *str);
+
+
+/**
+ * Start writing a JSON document.
+ *
+ * @param w Writer to initialize
+ * @param out Output stream
+ * @param pretty true to put each member on its own indented line
+ */
+void jbox_json_writer_init(jbox_json_writer_t *w, FILE *out, bool pretty);
+
+/** Open an object. */
+void jbox_json_begin_object(jbox_json_writer_t *w);
+
+/** Close the innermost object. */
+void jbox_json_end_object(jbox_json_writer_t *w);
+
+/** Open an array. */
+void jbox_json_begin_array(jbox_json_writer_t *w);
+
+/** Close the innermost array. */
+void jbox_json_end_array(jbox_json_writer_t *w);
+
+/**
+ * Write an object member name; the next value written is its value.
+ *
+ * @param w Writer
+ * @param key Member name
+ */
+void jbox_json_key(jbox_json_writer_t *w, const char *key);
+
+/**
+ * Write a string value.
+ *
+ * @param w Writer
+ * @param str String (NULL writes null)
+ */
+void jbox_json_string(jbox_json_writer_t *w, const char *str);
+
+/**
+ * Write a string value from bytes that may contain NULs.
+ *
+ * @param w Writer
+ * @param str Data
+ * @param len Length of str in bytes
+ */
+void jbox_json_string_n(jbox_json_writer_t *w, const char *str, size_t len);
+
+/**
+ * Write an integer value.
+ *
+ * @param w Writer
+ * @param value Number
+ */
+void jbox_json_int(jbox_json_writer_t *w, long long value);
+
+/**
+ * Write a boolean value.
+ *
+ * @param w Writer
+ * @param value true or false
+ */
+void jbox_json_bool(jbox_json_writer_t *w, bool value);
+
+/**
+ * Write null.
+ *
+ * @param w Writer
+ */
+void jbox_json_null(jbox_json_writer_t *w);
+
+/**
+ * Write a value that is already valid JSON text, such as a number token
+ * taken from another document.
+ *
+ * @param w Writer
+ * @param json JSON text
+ */
+void jbox_json_raw(jbox_json_writer_t *w, const char *json);
+
+#endif /* JBOX_JSON_H */
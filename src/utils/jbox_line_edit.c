@@ -0,0 +1,427 @@
+/**
+ * @file jbox_line_edit.c
+ * @brief Streaming line editor rewriting a file through a temporary copy.
+ *
+ * Lines are found with memchr() in a read buffer that is refilled by
+ * moving the partial line left at its end to the front; it grows only to
+ * hold a line longer than itself. Output collects in a buffer of the same
+ * size and goes out in large write()s. Once the edit is done, the rest of
+ * the original is copied with copy_file_range(), which the kernel may
+ * satisfy by sharing blocks, falling back to read() and write().
+ *
+ * jbox_line_edit_at() on a large file asks jbox_lineindex for the closest
+ * indexed line before its target and copies everything before that line
+ * the same way, so only the lines from there to the target are read.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "jbox_line_edit.h"
+#include "jbox_lineindex.h"
+
+
+/** Size of the read and write buffers */
+#define JBOX_LINE_EDIT_BUF (256 * 1024)
+
+/** Bytes moved per copy_file_range() call */
+#define JBOX_LINE_EDIT_CHUNK (8 * 1024 * 1024)
+
+
+/**
+ * Write all of a buffer, retrying on EINTR and short writes.
+ * @return 0 on success, -1 on error (errno set)
+ */
+static int write_all(int fd, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    buf += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+
+/**
+ * Write out the output buffer.
+ * @return 0 on success, -1 on error (errno set)
+ */
+static int flush_out(jbox_line_edit_t *ed) {
+  if (ed->out_len == 0) return 0;
+  int rc = write_all(ed->out_fd, ed->out, ed->out_len);
+  ed->out_len = 0;
+  return rc;
+}
+
+
+/**
+ * Double the read buffer.
+ * @return 0 on success, -1 if out of memory
+ */
+static int grow_in(jbox_line_edit_t *ed) {
+  char *grown = realloc(ed->in, ed->in_cap * 2);
+  if (!grown) return -1;
+  ed->in = grown;
+  ed->in_cap *= 2;
+  return 0;
+}
+
+
+/**
+ * Read more of the original, keeping the unread part of the buffer.
+ * @return 0 on success (in_eof set at the end), -1 on error (errno set)
+ */
+static int fill_in(jbox_line_edit_t *ed) {
+  size_t keep = ed->in_end - ed->in_start;
+  if (ed->in_start > 0) {
+    memmove(ed->in, ed->in + ed->in_start, keep);
+    ed->in_start = 0;
+    ed->in_end = keep;
+  }
+  if (ed->in_end == ed->in_cap && grow_in(ed) < 0) return -1;
+
+  ssize_t n;
+  do {
+    n = read(ed->in_fd, ed->in + ed->in_end, ed->in_cap - ed->in_end);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0) return -1;
+  if (n == 0) ed->in_eof = 1;
+  ed->in_end += (size_t)n;
+  return 0;
+}
+
+
+/**
+ * Close both files and free the buffers.
+ */
+static void release(jbox_line_edit_t *ed) {
+  if (ed->in_fd >= 0) close(ed->in_fd);
+  if (ed->out_fd >= 0) close(ed->out_fd);
+  ed->in_fd = -1;
+  ed->out_fd = -1;
+  free(ed->in);
+  free(ed->out);
+  ed->in = NULL;
+  ed->out = NULL;
+}
+
+
+/**
+ * Open the original and, unless only reading, the temporary file.
+ * @return 0 on success, -1 on error (errno set)
+ */
+static int open_files(jbox_line_edit_t *ed, const char *path, int writable) {
+  memset(ed, 0, sizeof(*ed));
+  ed->in_fd = -1;
+  ed->out_fd = -1;
+
+  if (!realpath(path, ed->target)) return -1;
+
+  ed->in_fd = open(ed->target, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (ed->in_fd < 0 || fstat(ed->in_fd, &st) < 0) goto fail;
+  if (S_ISDIR(st.st_mode)) {
+    errno = EISDIR;
+    goto fail;
+  }
+  posix_fadvise(ed->in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  if (writable) {
+    if (snprintf(ed->tmp, sizeof(ed->tmp), "%s.XXXXXX", ed->target) >=
+        (int)sizeof(ed->tmp)) {
+      errno = ENAMETOOLONG;
+      goto fail;
+    }
+    ed->out_fd = mkostemp(ed->tmp, O_CLOEXEC);
+    if (ed->out_fd < 0) goto fail;
+    if (fchmod(ed->out_fd, st.st_mode & 07777) < 0) goto fail_tmp;
+  }
+
+  ed->in_cap = JBOX_LINE_EDIT_BUF;
+  ed->in = malloc(ed->in_cap);
+  ed->out = writable ? malloc(JBOX_LINE_EDIT_BUF) : NULL;
+  if (!ed->in || (writable && !ed->out)) {
+    errno = ENOMEM;
+    goto fail_tmp;
+  }
+  return 0;
+
+fail_tmp:
+  unlink(ed->tmp);
+fail: {
+    int saved = errno;
+    release(ed);
+    errno = saved;
+  }
+  return -1;
+}
+
+
+int jbox_line_edit_open(jbox_line_edit_t *ed, const char *path) {
+  return open_files(ed, path, 1);
+}
+
+
+int jbox_line_edit_open_read(jbox_line_edit_t *ed, const char *path) {
+  return open_files(ed, path, 0);
+}
+
+
+int jbox_line_edit_next(jbox_line_edit_t *ed, const char **line,
+                        size_t *len) {
+  for (;;) {
+    char *start = ed->in + ed->in_start;
+    size_t avail = ed->in_end - ed->in_start;
+    char *nl = memchr(start, '\n', avail);
+    if (nl) {
+      *nl = '\0';
+      *line = start;
+      *len = (size_t)(nl - start);
+      ed->in_start += *len + 1;
+      return 1;
+    }
+    if (ed->in_eof) {
+      if (avail == 0) return 0;
+      /* A last line without a newline needs room for its NUL */
+      if (ed->in_end == ed->in_cap) {
+        if (grow_in(ed) < 0) return -1;
+        start = ed->in + ed->in_start;
+      }
+      ed->in[ed->in_end] = '\0';
+      *line = start;
+      *len = avail;
+      ed->in_start = ed->in_end;
+      return 1;
+    }
+    if (fill_in(ed) < 0) return -1;
+  }
+}
+
+
+int jbox_line_edit_write(jbox_line_edit_t *ed, const char *data,
+                         size_t len) {
+  if (ed->out_len + len > JBOX_LINE_EDIT_BUF) {
+    if (flush_out(ed) < 0) return -1;
+    if (len > JBOX_LINE_EDIT_BUF) return write_all(ed->out_fd, data, len);
+  }
+  memcpy(ed->out + ed->out_len, data, len);
+  ed->out_len += len;
+  return 0;
+}
+
+
+int jbox_line_edit_write_line(jbox_line_edit_t *ed, const char *data,
+                              size_t len) {
+  if (jbox_line_edit_write(ed, data, len) < 0) return -1;
+  return jbox_line_edit_write(ed, "\n", 1);
+}
+
+
+int jbox_line_edit_copy_rest(jbox_line_edit_t *ed) {
+  /* What is already buffered goes through the output buffer */
+  size_t avail = ed->in_end - ed->in_start;
+  char last = avail ? ed->in[ed->in_end - 1] : '\n';
+  if (jbox_line_edit_write(ed, ed->in + ed->in_start, avail) < 0 ||
+      flush_out(ed) < 0) {
+    return -1;
+  }
+  ed->in_start = ed->in_end;
+
+  int copied = 0;
+  while (!ed->in_eof) {
+    ssize_t n = copy_file_range(ed->in_fd, NULL, ed->out_fd, NULL,
+                                JBOX_LINE_EDIT_CHUNK, 0);
+    if (n > 0) {
+      copied = 1;
+      continue;
+    }
+    if (n == 0) {
+      ed->in_eof = 1;
+      break;
+    }
+    if (errno == EINTR) continue;
+    if (copied || (errno != EXDEV && errno != ENOSYS && errno != EINVAL &&
+                   errno != EOPNOTSUPP)) {
+      return -1;
+    }
+
+    /* No kernel copy between these files: fall back to the buffer */
+    while (!ed->in_eof) {
+      ed->in_start = ed->in_end = 0;
+      if (fill_in(ed) < 0) return -1;
+      if (ed->in_end == 0) break;
+      if (write_all(ed->out_fd, ed->in, ed->in_end) < 0) return -1;
+      last = ed->in[ed->in_end - 1];
+    }
+    ed->in_start = ed->in_end;
+  }
+
+  if (copied) {
+    off_t end = lseek(ed->in_fd, 0, SEEK_CUR);
+    if (end > 0 && pread(ed->in_fd, &last, 1, end - 1) != 1) return -1;
+  }
+  return last == '\n' ? 0 : write_all(ed->out_fd, "\n", 1);
+}
+
+
+/**
+ * Copy the first offset bytes of the original to the new file unchanged
+ * and go on reading after them; used right after opening.
+ * @return 0 on success, -1 on error (errno set)
+ */
+static int copy_prefix(jbox_line_edit_t *ed, off_t offset) {
+  off_t pos = 0;
+  while (pos < offset) {
+    ssize_t n = copy_file_range(ed->in_fd, &pos, ed->out_fd, NULL,
+                                (size_t)(offset - pos), 0);
+    if (n > 0) continue;
+    if (n == 0) {
+      errno = EIO;
+      return -1;
+    }
+    if (errno == EINTR) continue;
+    if (pos > 0 || (errno != EXDEV && errno != ENOSYS && errno != EINVAL &&
+                    errno != EOPNOTSUPP)) {
+      return -1;
+    }
+
+    /* No kernel copy between these files: go through the read buffer */
+    while (pos < offset) {
+      size_t want = (size_t)(offset - pos) < ed->in_cap
+                        ? (size_t)(offset - pos) : ed->in_cap;
+      n = pread(ed->in_fd, ed->in, want, pos);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) {
+        if (n == 0) errno = EIO;
+        return -1;
+      }
+      if (write_all(ed->out_fd, ed->in, (size_t)n) < 0) return -1;
+      pos += n;
+    }
+  }
+  return lseek(ed->in_fd, offset, SEEK_SET) < 0 ? -1 : 0;
+}
+
+
+int jbox_line_edit_commit(jbox_line_edit_t *ed) {
+  int failed = flush_out(ed) < 0 || fsync(ed->out_fd) < 0;
+  if (close(ed->out_fd) < 0) failed = 1;
+  ed->out_fd = -1;
+  if (failed || rename(ed->tmp, ed->target) < 0) {
+    int saved = errno;
+    unlink(ed->tmp);
+    release(ed);
+    errno = saved;
+    return -1;
+  }
+  release(ed);
+  return 0;
+}
+
+
+void jbox_line_edit_abort(jbox_line_edit_t *ed) {
+  if (ed->tmp[0]) unlink(ed->tmp);
+  release(ed);
+}
+
+
+int jbox_line_edit_at(const char *path, jbox_line_op_t op, size_t line,
+                      const char *text, size_t *count) {
+  jbox_line_edit_t ed;
+  if (jbox_line_edit_open(&ed, path) < 0) return -1;
+
+  /* Start at the closest indexed line, if the file is large enough */
+  jbox_lineindex_t idx;
+  int indexed = jbox_lineindex_open(&idx, ed.in_fd, ed.target) == 0;
+  size_t n = 0;
+  if (indexed) {
+    if (line > idx.lines + (op == JBOX_LINE_INSERT)) {
+      *count = idx.lines;
+      jbox_lineindex_free(&idx);
+      jbox_line_edit_abort(&ed);
+      return 1;
+    }
+    off_t offset;
+    n = jbox_lineindex_find(&idx, line, &offset) - 1;
+    if (n > 0 && copy_prefix(&ed, offset) < 0) goto fail;
+  }
+
+  /* Copy the lines before the target */
+  const char *cur = NULL;
+  size_t len = 0;
+  size_t text_len = op == JBOX_LINE_DELETE ? 0 : strlen(text);
+  int rc;
+  while ((rc = jbox_line_edit_next(&ed, &cur, &len)) == 1) {
+    if (++n == line) break;
+    if (jbox_line_edit_write_line(&ed, cur, len) < 0) {
+      rc = -1;
+      break;
+    }
+  }
+  if (rc < 0) goto fail;
+
+  if (rc == 0) {
+    /* Past the last line; only appending a line is allowed there */
+    if (op != JBOX_LINE_INSERT || line != n + 1) {
+      *count = n;
+      if (indexed) jbox_lineindex_free(&idx);
+      jbox_line_edit_abort(&ed);
+      return 1;
+    }
+    if (jbox_line_edit_write_line(&ed, text, text_len) < 0) goto fail;
+    if (indexed) jbox_lineindex_shift(&idx, line, 1, (off_t)text_len + 1);
+    goto commit;
+  }
+
+  switch (op) {
+    case JBOX_LINE_REPLACE:
+      rc = jbox_line_edit_write_line(&ed, text, text_len);
+      if (indexed) {
+        jbox_lineindex_shift(&idx, line, 0, (off_t)text_len - (off_t)len);
+      }
+      break;
+    case JBOX_LINE_INSERT:
+      rc = jbox_line_edit_write_line(&ed, text, text_len);
+      if (rc == 0) rc = jbox_line_edit_write_line(&ed, cur, len);
+      if (indexed) jbox_lineindex_shift(&idx, line, 1, (off_t)text_len + 1);
+      break;
+    case JBOX_LINE_DELETE:
+      rc = 0;
+      if (indexed) jbox_lineindex_shift(&idx, line, -1, -(off_t)len - 1);
+      break;
+  }
+  if (rc < 0 || jbox_line_edit_copy_rest(&ed) < 0) goto fail;
+
+commit:
+  if (jbox_line_edit_commit(&ed) < 0) {
+    int saved = errno;
+    if (indexed) jbox_lineindex_free(&idx);
+    errno = saved;
+    return -1;
+  }
+  if (indexed) {
+    /* ed.target outlives the commit, which only closes and frees */
+    jbox_lineindex_save(&idx, ed.target);
+    jbox_lineindex_free(&idx);
+  }
+  return 0;
+
+fail: {
+    int saved = errno;
+    if (indexed) jbox_lineindex_free(&idx);
+    jbox_line_edit_abort(&ed);
+    errno = saved;
+  }
+  return -1;
+}
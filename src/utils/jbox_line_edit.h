@@ -0,0 +1,144 @@
+#ifndef JBOX_LINE_EDIT_H
+#define JBOX_LINE_EDIT_H
+
+#include <limits.h>
+#include <stddef.h>
+
+
+/**
+ * Streaming line editor for rewriting a file in place.
+ *
+ * The file is read through a fixed buffer one line at a time while the
+ * edited text is written, through another, to a temporary file in the
+ * same directory. jbox_line_edit_commit() syncs the temporary file and
+ * renames it over the original, so memory use does not grow with the
+ * file, and a failure or crash at any point leaves either the old or the
+ * new contents, never a truncated file. A symlink is followed, so the
+ * file it names is replaced and the link is kept.
+ *
+ * Every line written ends in a newline, including a last line that had
+ * none in the original.
+ *
+ * The fields are private to jbox_line_edit.c.
+ */
+typedef struct {
+  int in_fd;
+  int out_fd;
+  char *in;                 /**< Read buffer */
+  size_t in_cap;
+  size_t in_start;          /**< Next unread line in the buffer */
+  size_t in_end;            /**< End of data in the buffer */
+  int in_eof;
+  char *out;                /**< Write buffer */
+  size_t out_len;
+  char target[PATH_MAX];    /**< File to replace, symlinks resolved */
+  char tmp[PATH_MAX];       /**< Temporary file beside it */
+} jbox_line_edit_t;
+
+/** Edits made by jbox_line_edit_at() */
+typedef enum {
+  JBOX_LINE_REPLACE,        /**< Replace the line with the text */
+  JBOX_LINE_INSERT,         /**< Insert the text before the line */
+  JBOX_LINE_DELETE          /**< Delete the line */
+} jbox_line_op_t;
+
+
+/**
+ * Open a file for editing and create the temporary file beside it, with
+ * the same permissions.
+ *
+ * @param ed Editor to initialize
+ * @param path File to edit
+ * @return 0 on success, -1 on error (errno set); on error ed needs no
+ *         jbox_line_edit_abort()
+ */
+int jbox_line_edit_open(jbox_line_edit_t *ed, const char *path);
+
+/**
+ * Open a file only to read its lines, with no temporary file. Only
+ * jbox_line_edit_next() and jbox_line_edit_abort() may be used on it.
+ *
+ * @param ed Editor to initialize
+ * @param path File to read
+ * @return 0 on success, -1 on error (errno set)
+ */
+int jbox_line_edit_open_read(jbox_line_edit_t *ed, const char *path);
+
+/**
+ * Read the next line of the original.
+ *
+ * @param ed Editor
+ * @param line Set to the line, without its newline and followed by a NUL;
+ *        valid until the next call
+ * @param len Set to the length of the line
+ * @return 1 if a line was read, 0 at the end of the file, -1 on error
+ *         (errno set)
+ */
+int jbox_line_edit_next(jbox_line_edit_t *ed, const char **line,
+                        size_t *len);
+
+/**
+ * Write text to the new file.
+ *
+ * @param ed Editor
+ * @param data Text to write
+ * @param len Length of data
+ * @return 0 on success, -1 on error (errno set)
+ */
+int jbox_line_edit_write(jbox_line_edit_t *ed, const char *data, size_t len);
+
+/**
+ * Write text followed by a newline to the new file.
+ *
+ * @param ed Editor
+ * @param data Line to write, without its newline
+ * @param len Length of data
+ * @return 0 on success, -1 on error (errno set)
+ */
+int jbox_line_edit_write_line(jbox_line_edit_t *ed, const char *data,
+                              size_t len);
+
+/**
+ * Copy the rest of the original to the new file unchanged, in blocks
+ * rather than lines, adding a newline at the end if it lacks one.
+ *
+ * @param ed Editor
+ * @return 0 on success, -1 on error (errno set)
+ */
+int jbox_line_edit_copy_rest(jbox_line_edit_t *ed);
+
+/**
+ * Replace the original with the new file and release the editor.
+ *
+ * @param ed Editor
+ * @return 0 on success, -1 on error (errno set; the original is left as
+ *         it was)
+ */
+int jbox_line_edit_commit(jbox_line_edit_t *ed);
+
+/**
+ * Discard the new file, leaving the original as it was, and release the
+ * editor.
+ *
+ * @param ed Editor
+ */
+void jbox_line_edit_abort(jbox_line_edit_t *ed);
+
+/**
+ * Replace, insert or delete one line of a file, streaming the rest.
+ *
+ * @param path File to edit
+ * @param op Edit to make
+ * @param line Line number, from 1; for JBOX_LINE_INSERT one past the last
+ *        line appends
+ * @param text Line to write, without its newline; unused for
+ *        JBOX_LINE_DELETE
+ * @param count Set to the number of lines in the file when line is past
+ *        its end
+ * @return 0 on success, 1 if line is past the end of the file (which is
+ *         left as it was), -1 on error (errno set)
+ */
+int jbox_line_edit_at(const char *path, jbox_line_op_t op, size_t line,
+                      const char *text, size_t *count);
+
+#endif /* JBOX_LINE_EDIT_H */
@@ -0,0 +1,335 @@
+/**
+ * @file jbox_lineindex.c
+ * @brief Line-offset indexes of large files in ~/.jshell/cache.
+ *
+ * A .jbli file is a fixed header (magic, format, the device, inode, size
+ * and mtime of the indexed file, its line count and the number of marks)
+ * followed by the marks as (line, offset) pairs. Storing the line number
+ * of each mark rather than implying it from the stride lets an edit shift
+ * the marks after it without a rescan. Building reads the file in large
+ * blocks and places marks with jbox_linereader_nth(), counting the rest
+ * of each block with jbox_linereader_count(). Files are written to a
+ * temporary name and renamed into place.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "jbox_lineindex.h"
+#include "jbox_linereader.h"
+
+
+#define LINEINDEX_MAGIC "JBLI"
+
+/** Bump whenever the file layout changes */
+#define LINEINDEX_FORMAT 1
+
+/** Bytes read per block while building */
+#define LINEINDEX_BLOCK (1024 * 1024)
+
+
+typedef struct {
+  char magic[4];
+  uint32_t format;
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint64_t lines;
+  uint64_t count;
+} lineindex_header_t;
+
+
+/**
+ * Gets the user's home directory.
+ * @return Home directory, or NULL if not found
+ */
+static const char *home_directory(void) {
+  const char *home = getenv("HOME");
+  if (home != NULL && home[0] != '\0') {
+    return home;
+  }
+
+  struct passwd *pw = getpwuid(getuid());
+  if (pw != NULL && pw->pw_dir != NULL) {
+    return pw->pw_dir;
+  }
+
+  return NULL;
+}
+
+
+/**
+ * Hashes bytes with FNV-1a.
+ * @param data Bytes to hash
+ * @param len Number of bytes
+ * @return Hash
+ */
+static uint64_t fnv1a(const void *data, size_t len) {
+  const unsigned char *p = data;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= p[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+
+/**
+ * Builds the path of a file's index, making the cache directory if
+ * needed.
+ * @param target Indexed file
+ * @param path Set to the index path
+ * @return 0 on success, -1 if there is no usable cache directory
+ */
+static int index_path(const char *target, char path[PATH_MAX]) {
+  const char *home = home_directory();
+  if (home == NULL) {
+    return -1;
+  }
+
+  snprintf(path, PATH_MAX, "%s/.jshell", home);
+  if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+    return -1;
+  }
+  snprintf(path, PATH_MAX, "%s%s", home, JBOX_LINEINDEX_SUBPATH);
+  if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+    return -1;
+  }
+  int n = snprintf(path, PATH_MAX, "%s%s/%016llx.jbli", home,
+                   JBOX_LINEINDEX_SUBPATH,
+                   (unsigned long long)fnv1a(target, strlen(target)));
+  return n < PATH_MAX ? 0 : -1;
+}
+
+
+/**
+ * Tells whether an index header describes a file as it is.
+ */
+static int header_matches(const lineindex_header_t *h, const struct stat *st) {
+  return memcmp(h->magic, LINEINDEX_MAGIC, 4) == 0 &&
+         h->format == LINEINDEX_FORMAT &&
+         h->dev == (uint64_t)st->st_dev &&
+         h->ino == (uint64_t)st->st_ino &&
+         h->size == (uint64_t)st->st_size &&
+         h->mtime_sec == (int64_t)st->st_mtim.tv_sec &&
+         h->mtime_nsec == (int64_t)st->st_mtim.tv_nsec;
+}
+
+
+/**
+ * Appends a mark.
+ * @return 0 on success, -1 if out of memory
+ */
+static int add_mark(jbox_lineindex_t *idx, uint64_t line, uint64_t offset) {
+  if (idx->count == idx->cap) {
+    size_t cap = idx->cap ? idx->cap * 2 : 256;
+    jbox_lineindex_mark_t *marks = realloc(idx->marks, cap * sizeof(*marks));
+    if (!marks) return -1;
+    idx->marks = marks;
+    idx->cap = cap;
+  }
+  idx->marks[idx->count].line = line;
+  idx->marks[idx->count].offset = offset;
+  idx->count++;
+  return 0;
+}
+
+
+/**
+ * Reads a saved index if it matches the file.
+ * @return 0 if loaded, -1 if missing, stale or damaged
+ */
+static int load(jbox_lineindex_t *idx, const struct stat *st) {
+  int fd = open(idx->path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return -1;
+
+  lineindex_header_t h;
+  int rc = -1;
+  if (read(fd, &h, sizeof(h)) != (ssize_t)sizeof(h) ||
+      !header_matches(&h, st) || h.count > (uint64_t)st->st_size) {
+    goto out;
+  }
+
+  size_t bytes = (size_t)h.count * sizeof(jbox_lineindex_mark_t);
+  idx->marks = malloc(bytes ? bytes : 1);
+  if (!idx->marks) goto out;
+  idx->cap = (size_t)h.count;
+  if (read(fd, idx->marks, bytes) != (ssize_t)bytes) goto out;
+  idx->count = (size_t)h.count;
+  idx->lines = (size_t)h.lines;
+  rc = 0;
+
+out:
+  close(fd);
+  return rc;
+}
+
+
+/**
+ * Scans a file for its line count and a mark every stride lines.
+ * @return 0 on success, -1 on error
+ */
+static int build(jbox_lineindex_t *idx, int fd, off_t size) {
+  char *block = malloc(LINEINDEX_BLOCK);
+  if (!block) return -1;
+
+  uint64_t line = 1;                    /* Line holding the next byte */
+  uint64_t next = 1 + JBOX_LINEINDEX_STRIDE;
+  off_t pos = 0;
+  char last = '\n';
+  while (pos < size) {
+    ssize_t n = pread(fd, block, LINEINDEX_BLOCK, pos);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      free(block);
+      return -1;
+    }
+
+    size_t at = 0;
+    for (;;) {
+      size_t rest = (size_t)n - at;
+      size_t nl = jbox_linereader_nth(block + at, rest,
+                                      (size_t)(next - line));
+      if (nl == rest) {
+        line += jbox_linereader_count(block + at, rest);
+        break;
+      }
+      at += nl + 1;
+      line = next;
+      if (pos + (off_t)at < size &&
+          add_mark(idx, line, (uint64_t)(pos + (off_t)at)) < 0) {
+        free(block);
+        return -1;
+      }
+      next += JBOX_LINEINDEX_STRIDE;
+    }
+    last = block[n - 1];
+    pos += n;
+  }
+  free(block);
+
+  /* Every newline opened a line; only a last line without one adds more */
+  idx->lines = (size_t)(line - 1) + (last != '\n');
+  return 0;
+}
+
+
+int jbox_lineindex_open(jbox_lineindex_t *idx, int fd, const char *target) {
+  memset(idx, 0, sizeof(*idx));
+
+  const char *off = getenv("JSHELL_NO_LINE_INDEX");
+  if (off != NULL && strcmp(off, "1") == 0) return -1;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+      st.st_size < JBOX_LINEINDEX_MIN_SIZE) {
+    return -1;
+  }
+  if (index_path(target, idx->path) < 0) return -1;
+
+  if (load(idx, &st) == 0) return 0;
+  jbox_lineindex_free(idx);
+
+  if (build(idx, fd, st.st_size) < 0) {
+    jbox_lineindex_free(idx);
+    return -1;
+  }
+  /* A failed save only costs the next run a rebuild */
+  jbox_lineindex_save(idx, target);
+  return 0;
+}
+
+
+size_t jbox_lineindex_find(const jbox_lineindex_t *idx, size_t line,
+                           off_t *offset) {
+  size_t lo = 0, hi = idx->count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (idx->marks[mid].line <= line) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == 0) {
+    *offset = 0;
+    return 1;
+  }
+  *offset = (off_t)idx->marks[lo - 1].offset;
+  return (size_t)idx->marks[lo - 1].line;
+}
+
+
+void jbox_lineindex_shift(jbox_lineindex_t *idx, size_t line, int lines,
+                          off_t bytes) {
+  size_t out = 0;
+  for (size_t i = 0; i < idx->count; i++) {
+    jbox_lineindex_mark_t m = idx->marks[i];
+    if (m.line > line) {
+      m.line += (uint64_t)(int64_t)lines;
+      m.offset += (uint64_t)(int64_t)bytes;
+    }
+    /* The mark after a deleted line lands on the line's own mark */
+    if (out > 0 && idx->marks[out - 1].line == m.line) continue;
+    idx->marks[out++] = m;
+  }
+  idx->count = out;
+  idx->lines += (size_t)(ssize_t)lines;
+}
+
+
+int jbox_lineindex_save(const jbox_lineindex_t *idx, const char *target) {
+  struct stat st;
+  if (stat(target, &st) < 0) return -1;
+
+  lineindex_header_t h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, LINEINDEX_MAGIC, 4);
+  h.format = LINEINDEX_FORMAT;
+  h.dev = (uint64_t)st.st_dev;
+  h.ino = (uint64_t)st.st_ino;
+  h.size = (uint64_t)st.st_size;
+  h.mtime_sec = (int64_t)st.st_mtim.tv_sec;
+  h.mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+  h.lines = idx->lines;
+  h.count = idx->count;
+
+  char tmp[PATH_MAX];
+  if (snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", idx->path,
+               (long)getpid()) >= (int)sizeof(tmp)) {
+    return -1;
+  }
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) return -1;
+
+  size_t bytes = idx->count * sizeof(jbox_lineindex_mark_t);
+  int failed = write(fd, &h, sizeof(h)) != (ssize_t)sizeof(h) ||
+               (bytes > 0 &&
+                write(fd, idx->marks, bytes) != (ssize_t)bytes);
+  if (close(fd) < 0) failed = 1;
+  if (failed || rename(tmp, idx->path) < 0) {
+    unlink(tmp);
+    return -1;
+  }
+  return 0;
+}
+
+
+void jbox_lineindex_free(jbox_lineindex_t *idx) {
+  free(idx->marks);
+  idx->marks = NULL;
+  idx->count = 0;
+  idx->cap = 0;
+  idx->lines = 0;
+}
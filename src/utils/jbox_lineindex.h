@@ -0,0 +1,98 @@
+#ifndef JBOX_LINEINDEX_H
+#define JBOX_LINEINDEX_H
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+
+/** Directory of line indexes, under the home directory */
+#define JBOX_LINEINDEX_SUBPATH "/.jshell/cache"
+
+/** Lines between the marks of a newly built index */
+#define JBOX_LINEINDEX_STRIDE 4096
+
+/** Smallest file worth indexing; smaller ones are scanned every time */
+#define JBOX_LINEINDEX_MIN_SIZE (1024 * 1024)
+
+
+/**
+ * Line-offset index of a large file, kept beside the compiled scripts in
+ * ~/.jshell/cache as <hash of the path>.jbli.
+ *
+ * The index records where every JBOX_LINEINDEX_STRIDE'th line starts and
+ * how many lines the file has, and is valid only for the device, inode,
+ * size and mtime it was built from, so any change to the file by another
+ * program makes it miss and be rebuilt. A tool that edits the file itself
+ * shifts the marks past its edit with jbox_lineindex_shift() and saves
+ * the index again for the new file. Set JSHELL_NO_LINE_INDEX=1 to neither
+ * read nor write indexes.
+ */
+typedef struct {
+  uint64_t line;            /**< Line number, from 1 */
+  uint64_t offset;          /**< Offset of the line's first byte */
+} jbox_lineindex_mark_t;
+
+typedef struct {
+  jbox_lineindex_mark_t *marks;   /**< Ascending by line */
+  size_t count;
+  size_t cap;
+  size_t lines;             /**< Lines in the file */
+  char path[PATH_MAX];      /**< Index file */
+} jbox_lineindex_t;
+
+
+/**
+ * Load the index of an open file, building and saving it if there is
+ * none or it is stale.
+ *
+ * @param idx Index to fill in; free with jbox_lineindex_free() on success
+ * @param fd Open file; read with pread(), so its position is kept
+ * @param target Absolute path of the file, symlinks resolved
+ * @return 0 if idx holds a valid index, -1 if the file is too small to
+ *         index, indexes are turned off, or an error occurred
+ */
+int jbox_lineindex_open(jbox_lineindex_t *idx, int fd, const char *target);
+
+/**
+ * Find the closest mark at or before a line.
+ *
+ * @param idx Index
+ * @param line Line number, from 1
+ * @param offset Set to the offset where the returned line starts
+ * @return Number of the marked line; 1 (offset 0) if no mark comes
+ *         before line
+ */
+size_t jbox_lineindex_find(const jbox_lineindex_t *idx, size_t line,
+                           off_t *offset);
+
+/**
+ * Move the marks past an edited line.
+ *
+ * @param idx Index
+ * @param line Line that was replaced, inserted or deleted
+ * @param lines Lines added (1), removed (-1) or 0
+ * @param bytes Bytes added or removed, newlines included
+ */
+void jbox_lineindex_shift(jbox_lineindex_t *idx, size_t line, int lines,
+                          off_t bytes);
+
+/**
+ * Save the index for the file as it now is on disk.
+ *
+ * @param idx Index
+ * @param target Path of the file, as given to jbox_lineindex_open()
+ * @return 0 on success, -1 on error
+ */
+int jbox_lineindex_save(const jbox_lineindex_t *idx, const char *target);
+
+/**
+ * Release an index.
+ *
+ * @param idx Index to free
+ */
+void jbox_lineindex_free(jbox_lineindex_t *idx);
+
+
+#endif /* JBOX_LINEINDEX_H */
@@ -0,0 +1,226 @@
+/**
+ * @file jbox_linereader.c
+ * @brief Line views and newline scanning shared by rg, tail, less and vi.
+ *
+ * Finding the next newline is memchr(), which libc already runs over
+ * vector registers. Counting newlines is the other hot loop (line
+ * numbers, skipping to a line, indexing a file) and memchr() stops at
+ * every hit, so jbox_linereader_count() instead tests eight bytes per
+ * step: XOR with a word of '\n' turns newlines into zero bytes, and an
+ * exact zero-byte test sets the top bit of each. Those bits are added
+ * into per-byte counters, summed every 255 steps, rather than
+ * popcounted: without -mpopcnt a popcount is a libgcc call.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "jbox_linereader.h"
+#include "jbox_signals.h"
+
+
+/** Initial size of a reader's buffer; it grows only for longer lines */
+#define LINEREADER_CHUNK (64 * 1024)
+
+/** Eight copies of a byte value */
+#define BYTES8(b) (0x0101010101010101ULL * (uint64_t)(b))
+
+
+/**
+ * Initializes a reader.
+ * @param reader Reader to initialize
+ * @param fd Descriptor to read from
+ * @return 0 on success, -1 on allocation failure
+ */
+int jbox_linereader_init(jbox_linereader_t *reader, int fd) {
+  reader->fd = fd;
+  reader->buf = malloc(LINEREADER_CHUNK);
+  reader->cap = LINEREADER_CHUNK;
+  reader->start = 0;
+  reader->end = 0;
+  reader->scanned = 0;
+  reader->eof = 0;
+  return reader->buf ? 0 : -1;
+}
+
+
+/**
+ * Frees a reader's buffer.
+ * @param reader Reader to free
+ */
+void jbox_linereader_free(jbox_linereader_t *reader) {
+  free(reader->buf);
+  reader->buf = NULL;
+}
+
+
+/**
+ * Reads more data behind the partial line.
+ * @param reader Reader
+ * @return Bytes read, 0 at end of input, -1 on error, -2 on interrupt
+ */
+ssize_t jbox_linereader_fill(jbox_linereader_t *reader) {
+  if (reader->start > 0) {
+    memmove(reader->buf, reader->buf + reader->start,
+            reader->end - reader->start);
+    reader->end -= reader->start;
+    reader->start = 0;
+  }
+  /* Keep a spare byte for the terminator of an unterminated last line */
+  if (reader->end + 1 >= reader->cap) {
+    char *grown = realloc(reader->buf, reader->cap * 2);
+    if (!grown) return -1;
+    reader->buf = grown;
+    reader->cap *= 2;
+  }
+
+  for (;;) {
+    ssize_t n = read(reader->fd, reader->buf + reader->end,
+                     reader->cap - reader->end - 1);
+    if (n >= 0) {
+      reader->end += (size_t)n;
+      return n;
+    }
+    if (errno != EINTR) return -1;
+    if (jbox_is_interrupted()) return -2;
+  }
+}
+
+
+/**
+ * Returns the next line, its newline replaced by a NUL in the buffer.
+ * @param reader Reader
+ * @param line Set to the line
+ * @param len Set to the length of the line
+ * @return 1 if a line was read, 0 at end of input, -1 on error,
+ *         -2 on interrupt
+ */
+int jbox_linereader_next(jbox_linereader_t *reader, char **line,
+                         size_t *len) {
+  for (;;) {
+    char *scan = reader->buf + reader->start + reader->scanned;
+    char *nl = memchr(scan, '\n', reader->end - reader->start
+                                  - reader->scanned);
+    if (nl) {
+      *nl = '\0';
+      *line = reader->buf + reader->start;
+      *len = (size_t)(nl - *line);
+      reader->start = (size_t)(nl - reader->buf) + 1;
+      reader->scanned = 0;
+      return 1;
+    }
+    reader->scanned = reader->end - reader->start;
+
+    if (reader->eof) {
+      if (reader->start == reader->end) return 0;
+      reader->buf[reader->end] = '\0';
+      *line = reader->buf + reader->start;
+      *len = reader->end - reader->start;
+      reader->start = reader->end;
+      reader->scanned = 0;
+      return 1;
+    }
+
+    ssize_t n = jbox_linereader_fill(reader);
+    if (n < 0) return (int)n;
+    if (n == 0) reader->eof = 1;
+  }
+}
+
+
+/**
+ * Adds up the eight byte lanes of a word.
+ */
+static inline size_t sum_bytes(uint64_t acc) {
+  uint64_t pairs = (acc & 0x00ff00ff00ff00ffULL) +
+                   ((acc >> 8) & 0x00ff00ff00ff00ffULL);
+  return (size_t)((pairs * 0x0001000100010001ULL) >> 48);
+}
+
+
+/**
+ * Counts the newlines in text, eight bytes per step.
+ * @param data Text
+ * @param len Length of the text
+ * @return Number of '\n' bytes
+ */
+size_t jbox_linereader_count(const char *data, size_t len) {
+  const unsigned char *p = (const unsigned char *)data;
+  size_t count = 0;
+
+  while (len > 0 && ((uintptr_t)p & 7) != 0) {
+    count += *p++ == '\n';
+    len--;
+  }
+
+  const uint64_t low7 = BYTES8(0x7f);
+  while (len >= 8) {
+    /* Each byte of acc counts the newlines in its lane, for at most 255
+     * words so it cannot overflow */
+    size_t words = len / 8 < 255 ? len / 8 : 255;
+    uint64_t acc = 0;
+    for (size_t i = 0; i < words; i++) {
+      uint64_t word;
+      memcpy(&word, p, sizeof(word));
+      uint64_t x = word ^ BYTES8('\n');
+      /* Top bit set exactly in the bytes of x that are zero */
+      uint64_t zero = ~(((x & low7) + low7) | x | low7);
+      acc += zero >> 7;
+      p += 8;
+    }
+    len -= words * 8;
+    count += sum_bytes(acc);
+  }
+
+  while (len > 0) {
+    count += *p++ == '\n';
+    len--;
+  }
+  return count;
+}
+
+
+/**
+ * Finds the nth newline in text.
+ * @param data Text
+ * @param len Length of the text
+ * @param n Which newline, from 1
+ * @return Offset of the nth '\n', or len if there are fewer
+ */
+size_t jbox_linereader_nth(const char *data, size_t len, size_t n) {
+  const char *p = data;
+  const char *end = data + len;
+  while (p < end) {
+    const char *nl = memchr(p, '\n', (size_t)(end - p));
+    if (!nl) break;
+    if (--n == 0) return (size_t)(nl - data);
+    p = nl + 1;
+  }
+  return len;
+}
+
+
+/**
+ * Steps backward over up to *count newlines.
+ * @param data Text
+ * @param len Length of the text
+ * @param count Newlines still wanted; decreased by those passed
+ * @return Offset just after the last newline passed once *count reaches
+ *         0, or (size_t)-1 if the text ran out first
+ */
+size_t jbox_linereader_back(const char *data, size_t len, size_t *count) {
+  size_t end = len;
+  const char *nl;
+  while (*count > 0 && end > 0 && (nl = memrchr(data, '\n', end)) != NULL) {
+    end = (size_t)(nl - data);
+    if (--*count == 0) {
+      return end + 1;
+    }
+  }
+  return (size_t)-1;
+}
@@ -0,0 +1,108 @@
+#ifndef JBOX_LINEREADER_H
+#define JBOX_LINEREADER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+
+/**
+ * Line views over text, shared by the tools that split input into lines.
+ *
+ * Lines are handed out as (pointer, length) views into a buffer the
+ * caller already has, such as a mapped file, or into one reusable chunk
+ * buffer, so no line is copied or allocated on its own. The scanning
+ * helpers count and find newlines a machine word at a time.
+ */
+
+
+/**
+ * Forward line reader over a file descriptor.
+ *
+ * Data is read in chunks into one buffer as it is needed, so a pipe is
+ * read while it is still being written and memory is bounded by the
+ * longest line. Callers may scan the buffered data, buf[start, end),
+ * themselves; one that then moves start to another line start sets
+ * scanned to how many bytes after it are known to hold no newline.
+ */
+typedef struct {
+  int fd;
+  char *buf;
+  size_t cap;
+  size_t start;         /**< First byte of the next line */
+  size_t end;           /**< End of buffered data */
+  size_t scanned;       /**< Bytes after start known to hold no '\n' */
+  int eof;
+} jbox_linereader_t;
+
+
+/**
+ * Initialize a reader.
+ *
+ * @param reader Reader to initialize
+ * @param fd Descriptor to read from (not closed by the reader)
+ * @return 0 on success, -1 on allocation failure
+ */
+int jbox_linereader_init(jbox_linereader_t *reader, int fd);
+
+/**
+ * Free a reader's buffer.
+ *
+ * @param reader Reader to free
+ */
+void jbox_linereader_free(jbox_linereader_t *reader);
+
+/**
+ * Read more data, first moving the partial line to the front of the
+ * buffer and growing it if that line already fills it.
+ *
+ * @param reader Reader
+ * @return Bytes read, 0 at end of input, -1 on error, -2 on interrupt
+ */
+ssize_t jbox_linereader_fill(jbox_linereader_t *reader);
+
+/**
+ * Return the next line.
+ *
+ * @param reader Reader
+ * @param line Set to the line, without its newline and followed by a
+ *        NUL; valid until the next call
+ * @param len Set to the length of the line
+ * @return 1 if a line was read, 0 at end of input, -1 on error,
+ *         -2 on interrupt
+ */
+int jbox_linereader_next(jbox_linereader_t *reader, char **line,
+                         size_t *len);
+
+/**
+ * Count the newlines in text.
+ *
+ * @param data Text
+ * @param len Length of the text
+ * @return Number of '\n' bytes
+ */
+size_t jbox_linereader_count(const char *data, size_t len);
+
+/**
+ * Find the nth newline in text.
+ *
+ * @param data Text
+ * @param len Length of the text
+ * @param n Which newline, from 1
+ * @return Offset of the nth '\n', or len if the text holds fewer
+ */
+size_t jbox_linereader_nth(const char *data, size_t len, size_t n);
+
+/**
+ * Step backward over up to *count newlines, for iterating lines from the
+ * end of text a block at a time.
+ *
+ * @param data Text (one block of a file, or all of it)
+ * @param len Length of the text
+ * @param count Newlines still wanted; decreased by the number passed
+ * @return Offset just after the newline that made *count 0, or
+ *         (size_t)-1 if the text holds fewer than were wanted
+ */
+size_t jbox_linereader_back(const char *data, size_t len, size_t *count);
+
+
+#endif
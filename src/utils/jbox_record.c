@@ -0,0 +1,453 @@
+/**
+ * @file jbox_record.c
+ * @brief Typed records between in-process pipeline stages.
+ *
+ * A record is kept encoded: fields are appended to one buffer, and
+ * reading a field walks it. The binary form on a pipe is that buffer
+ * behind a short header, so writing and reading a record are a copy
+ * each, with no escaping or tokenizing. Keys and values in the buffer
+ * are followed by a NUL, so fields can be used as C strings.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+
+#include "jbox_json.h"
+#include "jbox_record.h"
+
+
+/** Second byte of a binary record, after JBOX_RECORD_MAGIC */
+#define RECORD_TAG 'R'
+
+/** Bytes of a field before its key: type and key length */
+#define FIELD_HEAD (1 + sizeof(uint16_t))
+
+
+/**
+ * @brief Initializes an empty record.
+ *
+ * @param rec Record
+ */
+void jbox_record_init(jbox_record_t *rec) {
+  memset(rec, 0, sizeof(*rec));
+}
+
+
+/**
+ * @brief Frees a record's buffers.
+ *
+ * @param rec Record
+ */
+void jbox_record_free(jbox_record_t *rec) {
+  free(rec->buf);
+  free(rec->line);
+  jbox_record_init(rec);
+}
+
+
+/**
+ * @brief Removes all fields.
+ *
+ * @param rec Record
+ */
+void jbox_record_clear(jbox_record_t *rec) {
+  rec->len = 0;
+}
+
+
+/**
+ * @brief Makes room in the record's buffer.
+ *
+ * @param rec Record
+ * @param extra Bytes about to be appended
+ * @return true on success, false if memory ran out
+ */
+static bool record_reserve(jbox_record_t *rec, size_t extra) {
+  if (rec->len + extra <= rec->cap) {
+    return true;
+  }
+  size_t cap = rec->cap ? rec->cap : 256;
+  while (cap < rec->len + extra) {
+    cap *= 2;
+  }
+  char *grown = realloc(rec->buf, cap);
+  if (grown == NULL) {
+    return false;
+  }
+  rec->buf = grown;
+  rec->cap = cap;
+  return true;
+}
+
+
+/**
+ * @brief Appends bytes to the record's buffer, which has room for them.
+ *
+ * @param rec Record
+ * @param data Bytes
+ * @param len Number of bytes
+ */
+static void record_put(jbox_record_t *rec, const void *data, size_t len) {
+  memcpy(rec->buf + rec->len, data, len);
+  rec->len += len;
+}
+
+
+/**
+ * @brief Appends a field.
+ *
+ * @param rec Record
+ * @param type Value type
+ * @param key Field name
+ * @param key_len Length of key
+ * @param value Value bytes
+ * @param len Length of value
+ * @return 0 on success, -1 if memory ran out or the key is too long
+ */
+static int record_add(jbox_record_t *rec, jbox_field_type_t type,
+                      const char *key, size_t key_len,
+                      const void *value, size_t len) {
+  if (key_len > UINT16_MAX || len > UINT32_MAX
+      || !record_reserve(rec, FIELD_HEAD + key_len + 1
+                              + sizeof(uint32_t) + len + 1)) {
+    return -1;
+  }
+  uint8_t type_byte = (uint8_t)type;
+  uint16_t key_len16 = (uint16_t)key_len;
+  uint32_t len32 = (uint32_t)len;
+  record_put(rec, &type_byte, 1);
+  record_put(rec, &key_len16, sizeof(key_len16));
+  record_put(rec, key, key_len);
+  record_put(rec, "", 1);
+  record_put(rec, &len32, sizeof(len32));
+  if (len > 0) {
+    record_put(rec, value, len);
+  }
+  record_put(rec, "", 1);
+  return 0;
+}
+
+
+/**
+ * @brief Appends a string field.
+ *
+ * @param rec Record
+ * @param key Field name
+ * @param str Value bytes, or NULL for null
+ * @param len Length of str
+ * @return 0 on success, -1 if memory ran out
+ */
+int jbox_record_add_string_n(jbox_record_t *rec, const char *key,
+                             const char *str, size_t len) {
+  if (str == NULL) {
+    return record_add(rec, JBOX_FIELD_NULL, key, strlen(key), NULL, 0);
+  }
+  return record_add(rec, JBOX_FIELD_STRING, key, strlen(key), str, len);
+}
+
+
+/**
+ * @brief Appends a string field from a C string.
+ *
+ * @param rec Record
+ * @param key Field name
+ * @param str Value, or NULL for null
+ * @return 0 on success, -1 if memory ran out
+ */
+int jbox_record_add_string(jbox_record_t *rec, const char *key,
+                           const char *str) {
+  return jbox_record_add_string_n(rec, key, str,
+                                  str != NULL ? strlen(str) : 0);
+}
+
+
+/**
+ * @brief Appends an integer field.
+ *
+ * @param rec Record
+ * @param key Field name
+ * @param value Value
+ * @return 0 on success, -1 if memory ran out
+ */
+int jbox_record_add_int(jbox_record_t *rec, const char *key,
+                        long long value) {
+  int64_t v = value;
+  return record_add(rec, JBOX_FIELD_INT, key, strlen(key), &v, sizeof(v));
+}
+
+
+/**
+ * @brief Appends a boolean field.
+ *
+ * @param rec Record
+ * @param key Field name
+ * @param value Value
+ * @return 0 on success, -1 if memory ran out
+ */
+int jbox_record_add_bool(jbox_record_t *rec, const char *key, bool value) {
+  uint8_t v = value ? 1 : 0;
+  return record_add(rec, JBOX_FIELD_BOOL, key, strlen(key), &v, 1);
+}
+
+
+/**
+ * @brief Reads the next field.
+ *
+ * A truncated or inconsistent field ends the iteration, so a record
+ * read from a stream is never read past its end.
+ *
+ * @param rec Record
+ * @param pos Cursor, 0 for the first field
+ * @param field Set to the field
+ * @return true if a field was read
+ */
+bool jbox_record_next_field(const jbox_record_t *rec, size_t *pos,
+                            jbox_field_t *field) {
+  size_t p = *pos;
+  if (p + FIELD_HEAD > rec->len) {
+    return false;
+  }
+  uint8_t type = (uint8_t)rec->buf[p];
+  uint16_t key_len;
+  memcpy(&key_len, rec->buf + p + 1, sizeof(key_len));
+  p += FIELD_HEAD;
+  if (p + key_len + 1 + sizeof(uint32_t) > rec->len
+      || rec->buf[p + key_len] != '\0') {
+    return false;
+  }
+  field->key = rec->buf + p;
+  field->key_len = key_len;
+  p += (size_t)key_len + 1;
+
+  uint32_t len;
+  memcpy(&len, rec->buf + p, sizeof(len));
+  p += sizeof(len);
+  if (type > JBOX_FIELD_JSON || p + len + 1 > rec->len
+      || rec->buf[p + len] != '\0') {
+    return false;
+  }
+  field->type = (jbox_field_type_t)type;
+  field->str = rec->buf + p;
+  field->len = len;
+  field->num = 0;
+  if (type == JBOX_FIELD_INT && len == sizeof(int64_t)) {
+    int64_t v;
+    memcpy(&v, field->str, sizeof(v));
+    field->num = v;
+  } else if (type == JBOX_FIELD_BOOL && len == 1) {
+    field->num = field->str[0] != 0;
+  }
+  *pos = p + len + 1;
+  return true;
+}
+
+
+/**
+ * @brief Finds a field by name.
+ *
+ * @param rec Record
+ * @param key Field name
+ * @param field Set to the field
+ * @return true if found
+ */
+bool jbox_record_find(const jbox_record_t *rec, const char *key,
+                      jbox_field_t *field) {
+  size_t pos = 0;
+  while (jbox_record_next_field(rec, &pos, field)) {
+    if (strcmp(field->key, key) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+/**
+ * @brief Writes a record as one line of JSON.
+ *
+ * @param out Output stream
+ * @param rec Record
+ */
+static void write_json_line(FILE *out, const jbox_record_t *rec) {
+  jbox_json_writer_t w;
+  jbox_json_writer_init(&w, out, false);
+  jbox_json_begin_object(&w);
+  size_t pos = 0;
+  jbox_field_t field;
+  while (jbox_record_next_field(rec, &pos, &field)) {
+    jbox_json_key(&w, field.key);
+    switch (field.type) {
+      case JBOX_FIELD_NULL:   jbox_json_null(&w); break;
+      case JBOX_FIELD_BOOL:   jbox_json_bool(&w, field.num != 0); break;
+      case JBOX_FIELD_INT:    jbox_json_int(&w, field.num); break;
+      case JBOX_FIELD_STRING: jbox_json_string_n(&w, field.str, field.len);
+                              break;
+      case JBOX_FIELD_JSON:   jbox_json_raw(&w, field.str); break;
+    }
+  }
+  jbox_json_end_object(&w);
+  fputc('\n', out);
+}
+
+
+/**
+ * @brief Writes a record.
+ *
+ * @param out Output stream
+ * @param rec Record
+ * @param binary true for the binary form, false for an NDJSON line
+ * @return 0 on success, -1 on a write error
+ */
+int jbox_record_write(FILE *out, const jbox_record_t *rec, bool binary) {
+  if (!binary) {
+    write_json_line(out, rec);
+    return ferror(out) ? -1 : 0;
+  }
+
+  unsigned char head[2 + sizeof(uint32_t)] = { JBOX_RECORD_MAGIC,
+                                               RECORD_TAG };
+  uint32_t len = (uint32_t)rec->len;
+  memcpy(head + 2, &len, sizeof(len));
+  if (fwrite(head, 1, sizeof(head), out) != sizeof(head)
+      || fwrite(rec->buf, 1, rec->len, out) != rec->len) {
+    return -1;
+  }
+  return 0;
+}
+
+
+/**
+ * @brief Reads the body of a binary record whose magic byte was read.
+ *
+ * @param in Input stream
+ * @param rec Record, cleared
+ * @return 1 on success, -1 on a truncated or oversized record
+ */
+static int read_binary(FILE *in, jbox_record_t *rec) {
+  unsigned char head[1 + sizeof(uint32_t)];
+  if (fread(head, 1, sizeof(head), in) != sizeof(head)
+      || head[0] != RECORD_TAG) {
+    return -1;
+  }
+  uint32_t len;
+  memcpy(&len, head + 1, sizeof(len));
+  if (len > JBOX_RECORD_MAX_SIZE || !record_reserve(rec, len)
+      || fread(rec->buf, 1, len, in) != len) {
+    return -1;
+  }
+  rec->len = len;
+  return 1;
+}
+
+
+/**
+ * @brief Converts one JSON object into fields.
+ *
+ * @param rec Record, cleared
+ * @param line Text of the object
+ * @param len Length of line
+ * @return 1 on success, -1 if line is not one JSON object
+ */
+static int parse_json_line(jbox_record_t *rec, const char *line,
+                           size_t len) {
+  jbox_json_reader_t r;
+  jbox_json_reader_init(&r, line, len);
+  int rc = jbox_json_next(&r) == JBOX_JSON_OBJECT_BEGIN ? 1 : -1;
+  char *key = NULL;
+
+  while (rc == 1) {
+    jbox_json_event_t ev = jbox_json_next(&r);
+    if (ev == JBOX_JSON_OBJECT_END) {
+      break;
+    }
+    free(key);
+    key = ev == JBOX_JSON_KEY ? strdup(r.text) : NULL;
+    if (key == NULL) {
+      rc = -1;
+      break;
+    }
+
+    const char *start = r.pos;
+    ev = jbox_json_next(&r);
+    int added;
+    char *end;
+    switch (ev) {
+      case JBOX_JSON_STRING:
+        added = record_add(rec, JBOX_FIELD_STRING, key, strlen(key),
+                           r.text, r.text_len);
+        break;
+      case JBOX_JSON_NUMBER: {
+        errno = 0;
+        long long num = strtoll(r.text, &end, 10);
+        added = errno == 0 && *end == '\0'
+                ? jbox_record_add_int(rec, key, num)
+                : record_add(rec, JBOX_FIELD_JSON, key, strlen(key),
+                             r.text, r.text_len);
+        break;
+      }
+      case JBOX_JSON_TRUE:
+      case JBOX_JSON_FALSE:
+        added = jbox_record_add_bool(rec, key, ev == JBOX_JSON_TRUE);
+        break;
+      case JBOX_JSON_NULL:
+        added = record_add(rec, JBOX_FIELD_NULL, key, strlen(key), NULL, 0);
+        break;
+      case JBOX_JSON_OBJECT_BEGIN:
+      case JBOX_JSON_ARRAY_BEGIN:
+        added = jbox_json_skip(&r, ev) == 0
+                ? record_add(rec, JBOX_FIELD_JSON, key, strlen(key),
+                             start, (size_t)(r.pos - start))
+                : -1;
+        break;
+      default:
+        added = -1;
+        break;
+    }
+    if (added != 0) {
+      rc = -1;
+    }
+  }
+
+  if (rc == 1 && jbox_json_next(&r) != JBOX_JSON_DONE) {
+    rc = -1;
+  }
+  free(key);
+  jbox_json_reader_free(&r);
+  return rc;
+}
+
+
+/**
+ * @brief Reads the next record, binary or NDJSON.
+ *
+ * @param in Input stream
+ * @param rec Record to fill
+ * @return 1 if a record was read, 0 at end of input, -1 on bad input
+ */
+int jbox_record_read(FILE *in, jbox_record_t *rec) {
+  jbox_record_clear(rec);
+  for (;;) {
+    int c = fgetc(in);
+    if (c == EOF) {
+      return 0;
+    }
+    if (c == JBOX_RECORD_MAGIC) {
+      return read_binary(in, rec);
+    }
+    ungetc(c, in);
+
+    ssize_t len = getline(&rec->line, &rec->line_cap, in);
+    if (len <= 0) {
+      return 0;
+    }
+    size_t text = strspn(rec->line, " \t\r\n");
+    if ((size_t)len == text) {
+      continue;   /* Blank line */
+    }
+    return parse_json_line(rec, rec->line, (size_t)len);
+  }
+}
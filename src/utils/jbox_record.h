@@ -0,0 +1,180 @@
+#ifndef JBOX_RECORD_H
+#define JBOX_RECORD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * Typed records passed between in-process pipeline stages.
+ *
+ * A stage whose --json-stream output feeds a stage that reads records
+ * (the shell tells it so, see jbox_stdout_takes_records()) writes each
+ * object as a length-prefixed binary record instead of a JSON line, and
+ * the reader gets the fields back without parsing text. Records never
+ * leave the process, so lengths and integers are in host byte order:
+ *
+ *   0x1E 'R' u32 body-length body
+ *   body: per field, u8 type, u16 key-length, key, NUL,
+ *         u32 value-length, value, NUL
+ *
+ * Readers accept both forms line by line: a record starts with 0x1E,
+ * which no JSON text does, and anything else is read as one NDJSON
+ * object. Whoever is last in a pipeline renders records as JSON.
+ */
+
+/** First byte of a binary record (ASCII record separator) */
+#define JBOX_RECORD_MAGIC 0x1E
+
+/** Largest record body a reader accepts */
+#define JBOX_RECORD_MAX_SIZE (16 * 1024 * 1024)
+
+
+/** Type of a record field's value */
+typedef enum {
+  JBOX_FIELD_NULL,
+  JBOX_FIELD_BOOL,
+  JBOX_FIELD_INT,
+  JBOX_FIELD_STRING,
+  JBOX_FIELD_JSON,      /**< Other JSON (arrays, objects, fractions) */
+} jbox_field_type_t;
+
+
+/**
+ * One field of a record, pointing into the record's buffer; valid until
+ * the record changes.
+ */
+typedef struct {
+  jbox_field_type_t type;
+  const char *key;
+  size_t key_len;
+  const char *str;      /**< STRING bytes or JSON text, NUL-terminated */
+  size_t len;
+  long long num;        /**< INT value, or BOOL as 0/1 */
+} jbox_field_t;
+
+
+/**
+ * A record: its encoded body, reused between reads and writes so a
+ * stream of records costs no allocation once the buffer is big enough.
+ */
+typedef struct {
+  char *buf;
+  size_t len;
+  size_t cap;
+  char *line;           /**< NDJSON line buffer of the reader */
+  size_t line_cap;
+} jbox_record_t;
+
+
+/**
+ * Initialize an empty record.
+ *
+ * @param rec Record
+ */
+void jbox_record_init(jbox_record_t *rec);
+
+/**
+ * Release a record's buffers.
+ *
+ * @param rec Record
+ */
+void jbox_record_free(jbox_record_t *rec);
+
+/**
+ * Remove all fields, keeping the buffers.
+ *
+ * @param rec Record
+ */
+void jbox_record_clear(jbox_record_t *rec);
+
+/**
+ * Append a string field.
+ *
+ * @param rec Record
+ * @param key Field name
+ * @param str Value bytes (NULL adds null)
+ * @param len Length of str in bytes
+ * @return 0 on success, -1 if memory ran out
+ */
+int jbox_record_add_string_n(jbox_record_t *rec, const char *key,
+                             const char *str, size_t len);
+
+/**
+ * Append a string field from a C string.
+ *
+ * @param rec Record
+ * @param key Field name
+ * @param str Value (NULL adds null)
+ * @return 0 on success, -1 if memory ran out
+ */
+int jbox_record_add_string(jbox_record_t *rec, const char *key,
+                           const char *str);
+
+/**
+ * Append an integer field.
+ *
+ * @param rec Record
+ * @param key Field name
+ * @param value Value
+ * @return 0 on success, -1 if memory ran out
+ */
+int jbox_record_add_int(jbox_record_t *rec, const char *key,
+                        long long value);
+
+/**
+ * Append a boolean field.
+ *
+ * @param rec Record
+ * @param key Field name
+ * @param value Value
+ * @return 0 on success, -1 if memory ran out
+ */
+int jbox_record_add_bool(jbox_record_t *rec, const char *key, bool value);
+
+/**
+ * Iterate over the fields of a record.
+ *
+ * @param rec Record
+ * @param pos Cursor, 0 for the first field
+ * @param field Set to the next field
+ * @return true if a field was read, false after the last one
+ */
+bool jbox_record_next_field(const jbox_record_t *rec, size_t *pos,
+                            jbox_field_t *field);
+
+/**
+ * Find a field by name.
+ *
+ * @param rec Record
+ * @param key Field name
+ * @param field Set to the field
+ * @return true if found
+ */
+bool jbox_record_find(const jbox_record_t *rec, const char *key,
+                      jbox_field_t *field);
+
+/**
+ * Write a record, binary or as one line of JSON.
+ *
+ * @param out Output stream
+ * @param rec Record
+ * @param binary true to write the binary form, for a stage reading
+ *        records; false for an NDJSON line
+ * @return 0 on success, -1 on a write error
+ */
+int jbox_record_write(FILE *out, const jbox_record_t *rec, bool binary);
+
+/**
+ * Read the next record, binary or an NDJSON line with one object.
+ * Strings, integers, booleans and null become typed fields; other
+ * values are kept as JSON text. Blank lines are skipped.
+ *
+ * @param in Input stream
+ * @param rec Record to fill (cleared first)
+ * @return 1 if a record was read, 0 at end of input, -1 if the input is
+ *         not a record or JSON object (the bad line is consumed)
+ */
+int jbox_record_read(FILE *in, jbox_record_t *rec);
+
+#endif /* JBOX_RECORD_H */
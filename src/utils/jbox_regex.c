@@ -0,0 +1,1450 @@
+/**
+ * @file jbox_regex.c
+ * @brief POSIX extended regex matching on a lazily built DFA.
+ *
+ * A pattern is parsed into a syntax tree and compiled twice into Thompson
+ * NFA programs, once forwards and once reversed. Two DFAs are built from
+ * them on demand, each caching the transitions it has seen:
+ *
+ * - forward: unanchored, with threads kept in order of where they started
+ *   as in RE2's longest-match mode; it stops at the first accepting byte
+ *   when only a yes/no answer is needed, and otherwise runs until the
+ *   leftmost match can grow no further, giving the end of that match;
+ * - backward: the reversed program, anchored at that end; the last
+ *   position it accepts at is where the match starts.
+ *
+ * Together these give POSIX leftmost-longest offsets in linear time.
+ * Empty-width assertions (^ $ \b \< \>) depend on the bytes on both
+ * sides, so a DFA state records the previous byte's kind and assertions
+ * are resolved while computing the transition on the next byte; the end
+ * of text is an extra byte class of its own. When a DFA's cache fills up
+ * it is flushed and rebuilt from the current state, as in RE2, keeping
+ * memory bounded on any input.
+ *
+ * Bytes are handled as in the C locale, matching how jbox runs regcomp().
+ */
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jbox_regex.h"
+
+
+/** Largest NFA program; bigger patterns (e.g. huge {n,m}) use POSIX */
+#define REGEX_MAX_INSTS 20000
+
+/** Deepest group nesting the parser accepts */
+#define REGEX_MAX_DEPTH 250
+
+/** DFA states cached before the cache is flushed */
+#define REGEX_MAX_STATES 8192
+
+/** Bytes to scan between flushes for the DFA to be worth keeping */
+#define REGEX_MIN_FLUSH_BYTES (10 * REGEX_MAX_STATES)
+
+/** Hash table slots for DFA state lookup (power of two) */
+#define REGEX_HASH_SLOTS (REGEX_MAX_STATES * 2)
+
+
+/** NFA instruction opcodes. */
+enum {
+  OP_SET,                 /**< Consume a byte in set `arg` */
+  OP_SPLIT,               /**< Continue at both out and out1 */
+  OP_ASSERT,              /**< Continue at out if assertion `arg` holds */
+  OP_MATCH,
+};
+
+/** Empty-width assertions. */
+enum {
+  AS_BOL,                 /**< ^ */
+  AS_EOL,                 /**< $ */
+  AS_WORD_BOUNDARY,       /**< \b */
+  AS_WORD_START,          /**< \< */
+  AS_WORD_END,            /**< \> */
+};
+
+/** Syntax tree node types. */
+enum {
+  N_EMPTY,
+  N_SET,                  /**< arg: byte set index */
+  N_ASSERT,               /**< arg: assertion */
+  N_CAT,                  /**< Children in order */
+  N_ALT,                  /**< Alternatives */
+  N_REPEAT,               /**< child{min,max}, max -1 for unbounded */
+};
+
+/** Kernel entries that are not instructions. */
+enum {
+  K_MARK = -1,            /**< Separates threads with different starts */
+  K_RESTART = -2,         /**< Start a new thread here (unanchored) */
+};
+
+/** DFA state flags describing the byte before the current position. */
+enum {
+  F_START = 1,            /**< Start of text, or after '\n' (REG_NEWLINE) */
+  F_WORD = 2,             /**< A word character */
+};
+
+
+/** Set of bytes. */
+typedef struct {
+  uint64_t bits[4];
+} byteset_t;
+
+/** Syntax tree node; children are linked through `next`. */
+typedef struct {
+  int type;
+  int arg;
+  int min;
+  int max;
+  int child;              /**< First child, -1 if none */
+  int last;               /**< Last child, for appending */
+  int next;               /**< Next sibling, -1 if none */
+} node_t;
+
+/** NFA instruction. */
+typedef struct {
+  int op;
+  int arg;
+  int out;
+  int out1;
+} inst_t;
+
+/** Compiled NFA program. */
+typedef struct {
+  inst_t *insts;
+  int count;
+  int cap;
+  int start;
+} code_t;
+
+/** Cached DFA state. */
+typedef struct {
+  int *kernel;            /**< Live threads, see dfa_transition() */
+  int nkernel;
+  unsigned flags;
+  uint32_t hash;
+  int32_t *next;          /**< Per byte class: (state << 1) | matched */
+} dfa_state_t;
+
+/** Lazily built DFA over one program. */
+typedef struct {
+  const code_t *code;
+  bool unanchored;        /**< Starts a thread at every position */
+  dfa_state_t *states;
+  int count;
+  int cap;
+  int *slots;             /**< Hash table of state indexes, -1 if empty */
+  int start[4];           /**< Cached start state per flags, -1 if none */
+  unsigned flushes;       /**< Times the cache has been flushed */
+  size_t scanned;         /**< Bytes scanned over the DFA's lifetime */
+  size_t flushed_at;      /**< Value of scanned at the last flush */
+} dfa_t;
+
+struct jbox_regex_prog {
+  byteset_t *sets;
+  int nsets;
+  code_t program;
+  code_t reversed;
+  bool newline;
+
+  uint8_t class_of[256];
+  int nclasses;           /**< Byte classes; class nclasses is end of text */
+  uint8_t class_rep[256];
+  bool class_word[256];
+  bool class_nl[256];
+
+  dfa_t forward;
+  dfa_t backward;
+
+  /* Scratch space for computing transitions */
+  int *stack;
+  int *list;
+  unsigned *mark;         /**< Instructions visited, by generation */
+  unsigned *seen;         /**< Instructions queued for the next byte */
+  unsigned gen;
+};
+
+/** Parser state. */
+typedef struct {
+  const char *p;
+  bool icase;
+  bool newline;
+  bool leading;           /**< Nothing that consumes input precedes p */
+  int depth;
+  node_t *nodes;
+  int nnodes;
+  int node_cap;
+  byteset_t *sets;
+  int nsets;
+  int set_cap;
+} parser_t;
+
+
+// ---------------------------------------------------------------------------
+// Byte sets
+// ---------------------------------------------------------------------------
+
+static void set_add(byteset_t *s, unsigned c) {
+  s->bits[c >> 6] |= (uint64_t)1 << (c & 63);
+}
+
+
+static bool set_has(const byteset_t *s, unsigned c) {
+  return (s->bits[c >> 6] >> (c & 63)) & 1;
+}
+
+
+/**
+ * @brief Checks for a word character (alphanumeric or '_').
+ *
+ * @param c Byte
+ * @return true if c is a word character in the C locale
+ */
+static bool is_word_byte(unsigned c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+         || (c >= '0' && c <= '9') || c == '_';
+}
+
+
+/**
+ * @brief Adds the other case of every ASCII letter in a set.
+ *
+ * @param s Set to fold
+ */
+static void set_fold(byteset_t *s) {
+  for (unsigned c = 'a'; c <= 'z'; c++) {
+    unsigned u = c - 'a' + 'A';
+    if (set_has(s, c) || set_has(s, u)) {
+      set_add(s, c);
+      set_add(s, u);
+    }
+  }
+}
+
+
+/**
+ * @brief Adds a POSIX character class to a set.
+ *
+ * @param s Set to add to
+ * @param name Class name, e.g. "alpha"
+ * @param len Length of name
+ * @return false if the class is unknown
+ */
+static bool set_add_class(byteset_t *s, const char *name, size_t len) {
+  static const char *const names[] = {
+    "alpha", "digit", "alnum", "upper", "lower", "space",
+    "blank", "punct", "print", "graph", "cntrl", "xdigit",
+  };
+  int which = -1;
+  for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++) {
+    if (strlen(names[i]) == len && memcmp(names[i], name, len) == 0) {
+      which = i;
+    }
+  }
+  if (which < 0) return false;
+
+  for (unsigned c = 0; c < 128; c++) {
+    bool upper = c >= 'A' && c <= 'Z';
+    bool lower = c >= 'a' && c <= 'z';
+    bool digit = c >= '0' && c <= '9';
+    bool space = c == ' ' || (c >= '\t' && c <= '\r');
+    bool print = c >= ' ' && c < 127;
+    bool in;
+    switch (which) {
+      case 0: in = upper || lower; break;
+      case 1: in = digit; break;
+      case 2: in = upper || lower || digit; break;
+      case 3: in = upper; break;
+      case 4: in = lower; break;
+      case 5: in = space; break;
+      case 6: in = c == ' ' || c == '\t'; break;
+      case 7: in = print && c != ' ' && !upper && !lower && !digit; break;
+      case 8: in = print; break;
+      case 9: in = print && c != ' '; break;
+      case 10: in = c < ' ' || c == 127; break;
+      default: in = digit || (c >= 'a' && c <= 'f')
+                   || (c >= 'A' && c <= 'F'); break;
+    }
+    if (in) set_add(s, c);
+  }
+  return true;
+}
+
+
+// ---------------------------------------------------------------------------
+// Parser
+// ---------------------------------------------------------------------------
+
+static int new_node(parser_t *ps, int type) {
+  if (ps->nnodes >= ps->node_cap) {
+    int cap = ps->node_cap ? ps->node_cap * 2 : 64;
+    node_t *grown = realloc(ps->nodes, (size_t)cap * sizeof(node_t));
+    if (!grown) return -1;
+    ps->nodes = grown;
+    ps->node_cap = cap;
+  }
+  node_t *n = &ps->nodes[ps->nnodes];
+  memset(n, 0, sizeof(*n));
+  n->type = type;
+  n->child = n->last = n->next = -1;
+  return ps->nnodes++;
+}
+
+
+static void add_child(parser_t *ps, int parent, int child) {
+  node_t *p = &ps->nodes[parent];
+  if (p->last < 0) {
+    p->child = child;
+  } else {
+    ps->nodes[p->last].next = child;
+  }
+  p->last = child;
+}
+
+
+/**
+ * @brief Creates a node matching one byte of a set.
+ *
+ * @param ps Parser
+ * @param set Bytes to match (folded first under REG_ICASE)
+ * @return Node index, or -1 on allocation failure
+ */
+static int set_node(parser_t *ps, byteset_t set) {
+  if (ps->icase) set_fold(&set);
+  if (ps->nsets >= ps->set_cap) {
+    int cap = ps->set_cap ? ps->set_cap * 2 : 32;
+    byteset_t *grown = realloc(ps->sets, (size_t)cap * sizeof(byteset_t));
+    if (!grown) return -1;
+    ps->sets = grown;
+    ps->set_cap = cap;
+  }
+  int n = new_node(ps, N_SET);
+  if (n < 0) return -1;
+  ps->sets[ps->nsets] = set;
+  ps->nodes[n].arg = ps->nsets++;
+  return n;
+}
+
+
+static int byte_node(parser_t *ps, unsigned c) {
+  byteset_t set = {0};
+  set_add(&set, c);
+  return set_node(ps, set);
+}
+
+
+static int assert_node(parser_t *ps, int kind) {
+  int n = new_node(ps, N_ASSERT);
+  if (n >= 0) ps->nodes[n].arg = kind;
+  return n;
+}
+
+
+/**
+ * @brief Parses a bracket expression; ps->p is just past the '['.
+ *
+ * @param ps Parser
+ * @return Node index, or -1 if unsupported or on allocation failure
+ */
+static int parse_bracket(parser_t *ps) {
+  const char *p = ps->p;
+  bool negate = *p == '^';
+  if (negate) p++;
+
+  byteset_t set = {0};
+  bool first = true;
+  for (;;) {
+    if (*p == '\0') return -1;
+    if (*p == ']' && !first) {
+      p++;
+      break;
+    }
+    first = false;
+
+    if (p[0] == '[' && p[1] == ':') {
+      const char *end = strstr(p + 2, ":]");
+      if (!end || !set_add_class(&set, p + 2, (size_t)(end - p - 2))) {
+        return -1;
+      }
+      p = end + 2;
+      continue;
+    }
+    if (p[0] == '[' && (p[1] == '.' || p[1] == '=')) {
+      return -1;          /* Collating elements: left to POSIX */
+    }
+
+    unsigned lo = (unsigned char)*p++;
+    if (p[0] == '-' && p[1] != ']' && p[1] != '\0') {
+      if (p[1] == '[' && (p[2] == '.' || p[2] == '=' || p[2] == ':')) {
+        return -1;
+      }
+      unsigned hi = (unsigned char)p[1];
+      p += 2;
+      if (hi < lo) return -1;
+      for (unsigned c = lo; c <= hi; c++) set_add(&set, c);
+    } else {
+      set_add(&set, lo);
+    }
+  }
+  ps->p = p;
+
+  /* Fold before complementing, as regcomp translates both pattern and
+   * input under REG_ICASE */
+  if (ps->icase) set_fold(&set);
+  if (negate) {
+    for (int i = 0; i < 4; i++) set.bits[i] = ~set.bits[i];
+    if (ps->newline) {
+      set.bits['\n' >> 6] &= ~((uint64_t)1 << ('\n' & 63));
+    }
+  }
+  return set_node(ps, set);
+}
+
+
+/**
+ * @brief Parses a backslash escape; ps->p is just past the '\'.
+ *
+ * @param ps Parser
+ * @return Node index, or -1 if unsupported or on allocation failure
+ */
+static int parse_escape(parser_t *ps) {
+  unsigned c = (unsigned char)*ps->p;
+  if (c == '\0' || (c >= '1' && c <= '9') || c == '`' || c == '\'') {
+    return -1;            /* Backreferences and buffer anchors: POSIX */
+  }
+  ps->p++;
+
+  byteset_t set = {0};
+  switch (c) {
+    case 'b': return assert_node(ps, AS_WORD_BOUNDARY);
+    case 'B':
+      return -1;          /* glibc's \B disagrees with itself after a
+                           * repeat ("A*\B" on "BA-" finds 2 before 1) */
+    case '<': return assert_node(ps, AS_WORD_START);
+    case '>': return assert_node(ps, AS_WORD_END);
+    case 'w':
+    case 'W':
+      for (unsigned b = 0; b < 256; b++) {
+        if (is_word_byte(b) == (c == 'w')) set_add(&set, b);
+      }
+      return set_node(ps, set);
+    case 's':
+    case 'S':
+      for (unsigned b = 0; b < 256; b++) {
+        bool space = b == ' ' || (b >= '\t' && b <= '\r');
+        if (space == (c == 's')) set_add(&set, b);
+      }
+      return set_node(ps, set);
+    default:
+      return byte_node(ps, c);
+  }
+}
+
+
+static int parse_alt(parser_t *ps);
+
+
+/**
+ * @brief Skips to the ')' closing the current group, or the end.
+ *
+ * @param p Position inside the group
+ * @return Position of the ')' or the terminating NUL
+ */
+static const char *skip_group(const char *p) {
+  int level = 0;
+  while (*p) {
+    if (*p == '\\' && p[1] != '\0') {
+      p += 2;
+    } else if (*p == '[') {
+      p++;
+      if (*p == '^') p++;
+      if (*p == ']') p++;
+      while (*p && *p != ']') {
+        const char *end = NULL;
+        if (p[0] == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '=')) {
+          char close[3] = { p[1], ']', '\0' };
+          end = strstr(p + 2, close);
+        }
+        p = end ? end + 2 : p + 1;
+      }
+      if (*p) p++;
+    } else if (*p == '(') {
+      level++;
+      p++;
+    } else if (*p == ')') {
+      if (level-- == 0) return p;
+      p++;
+    } else {
+      p++;
+    }
+  }
+  return p;
+}
+
+
+/**
+ * @brief Checks that nothing can be matched after a position.
+ *
+ * glibc does not treat ^ and $ consistently when something may be
+ * matched on their far side (e.g. "a$\nb" never matches, yet "a$\s*b"
+ * can match across a newline without REG_NEWLINE). The DFA only takes
+ * anchors at the edges of the pattern, leaving the rest to regexec().
+ *
+ * @param p Position just after a '$'
+ * @return true if only group ends and other alternatives follow
+ */
+static bool at_pattern_end(const char *p) {
+  for (;;) {
+    if (*p == '\0') return true;
+    if (*p == '$') {
+      p++;
+    } else if (*p == '|') {
+      p = skip_group(p);
+    } else if (*p == ')') {
+      p++;
+      if (*p == '*' || *p == '+' || *p == '?' || *p == '{') return false;
+    } else {
+      return false;
+    }
+  }
+}
+
+
+/**
+ * @brief Parses one atom: a byte, set, group, anchor or escape.
+ *
+ * @param ps Parser
+ * @return Node index, or -1 if unsupported or on allocation failure
+ */
+static int parse_atom(parser_t *ps) {
+  unsigned c = (unsigned char)*ps->p;
+  switch (c) {
+    case '(': {
+      ps->p++;
+      if (++ps->depth > REGEX_MAX_DEPTH) return -1;
+      int inner;
+      if (*ps->p == ')') {
+        inner = new_node(ps, N_EMPTY);
+      } else {
+        inner = parse_alt(ps);
+      }
+      if (inner < 0 || *ps->p != ')') return -1;
+      ps->p++;
+      ps->depth--;
+      return inner;
+    }
+    case '.': {
+      byteset_t set;
+      memset(&set, 0xff, sizeof(set));
+      set.bits[0] &= ~(uint64_t)1;     /* '.' never matches NUL */
+      if (ps->newline) {
+        set.bits[0] &= ~((uint64_t)1 << '\n');
+      }
+      ps->p++;
+      return set_node(ps, set);
+    }
+    case '^':
+      if (!ps->leading) return -1;
+      ps->p++;
+      return assert_node(ps, AS_BOL);
+    case '$':
+      ps->p++;
+      if (!at_pattern_end(ps->p)) return -1;
+      return assert_node(ps, AS_EOL);
+    case '[':
+      ps->p++;
+      return parse_bracket(ps);
+    case '\\':
+      ps->p++;
+      return parse_escape(ps);
+    case ')':
+    case '*':
+    case '+':
+    case '?':
+    case '{':
+      return -1;          /* Context-dependent in regcomp: left to POSIX */
+    default:
+      ps->p++;
+      return byte_node(ps, c);
+  }
+}
+
+
+/**
+ * @brief Parses a decimal number for an interval bound.
+ *
+ * @param ps Parser
+ * @return The number, or -1 if there are no digits or it is too large
+ */
+static int parse_bound(parser_t *ps) {
+  if (*ps->p < '0' || *ps->p > '9') return -1;
+  int value = 0;
+  while (*ps->p >= '0' && *ps->p <= '9') {
+    value = value * 10 + (*ps->p++ - '0');
+    if (value > RE_DUP_MAX) return -1;
+  }
+  return value;
+}
+
+
+/**
+ * @brief Parses an atom and any quantifiers after it.
+ *
+ * @param ps Parser
+ * @return Node index, or -1 if unsupported or on allocation failure
+ */
+static int parse_piece(parser_t *ps) {
+  int first = ps->nnodes;
+  int atom = parse_atom(ps);
+  if (atom < 0) return -1;
+
+  while (*ps->p == '*' || *ps->p == '+' || *ps->p == '?' || *ps->p == '{') {
+    /* glibc evaluates assertions inside repeated groups against the wrong
+     * context (b(\b..)+ matches all of "b-bbbxc"); leave those to it */
+    for (int i = first; i < ps->nnodes; i++) {
+      if (ps->nodes[i].type == N_ASSERT) return -1;
+    }
+    int min = 0;
+    int max = -1;
+    char q = *ps->p++;
+    if (q == '+') {
+      min = 1;
+    } else if (q == '?') {
+      max = 1;
+    } else if (q == '{') {
+      min = *ps->p == ',' ? 0 : parse_bound(ps);
+      if (min < 0) return -1;
+      if (*ps->p == ',') {
+        ps->p++;
+        if (*ps->p != '}') {
+          max = parse_bound(ps);
+          if (max < min) return -1;
+        }
+      } else {
+        max = min;
+      }
+      if (*ps->p++ != '}') return -1;
+    }
+
+    int rep = new_node(ps, N_REPEAT);
+    if (rep < 0) return -1;
+    ps->nodes[rep].min = min;
+    ps->nodes[rep].max = max;
+    add_child(ps, rep, atom);
+    atom = rep;
+  }
+  return atom;
+}
+
+
+/**
+ * @brief Parses a sequence of pieces up to '|', ')' or the end.
+ *
+ * @param ps Parser
+ * @return Node index, or -1 if unsupported or on allocation failure
+ */
+static int parse_branch(parser_t *ps) {
+  int cat = new_node(ps, N_CAT);
+  if (cat < 0) return -1;
+  bool leading = ps->leading;
+  while (*ps->p != '\0' && *ps->p != '|') {
+    if (*ps->p == ')') {
+      if (ps->depth == 0) return -1;  /* regcomp takes it literally */
+      break;
+    }
+    int piece = parse_piece(ps);
+    if (piece < 0) return -1;
+    add_child(ps, cat, piece);
+    if (ps->nodes[piece].type != N_ASSERT) ps->leading = false;
+  }
+  ps->leading = leading;
+  return cat;
+}
+
+
+static int parse_alt(parser_t *ps) {
+  int branch = parse_branch(ps);
+  if (branch < 0 || *ps->p != '|') return branch;
+
+  int alt = new_node(ps, N_ALT);
+  if (alt < 0) return -1;
+  add_child(ps, alt, branch);
+  while (*ps->p == '|') {
+    ps->p++;
+    branch = parse_branch(ps);
+    if (branch < 0) return -1;
+    add_child(ps, alt, branch);
+  }
+  return alt;
+}
+
+
+// ---------------------------------------------------------------------------
+// NFA compilation
+// ---------------------------------------------------------------------------
+
+static int emit(code_t *code, int op, int arg, int out, int out1) {
+  if (code->count >= REGEX_MAX_INSTS) return -1;
+  if (code->count >= code->cap) {
+    int cap = code->cap ? code->cap * 2 : 64;
+    inst_t *grown = realloc(code->insts, (size_t)cap * sizeof(inst_t));
+    if (!grown) return -1;
+    code->insts = grown;
+    code->cap = cap;
+  }
+  code->insts[code->count] = (inst_t){ op, arg, out, out1 };
+  return code->count++;
+}
+
+
+/**
+ * @brief Compiles a node so that it continues at `next`.
+ *
+ * Code is generated back to front, which makes concatenation a loop and
+ * lets the reversed program be built from the same tree by walking
+ * sequences the other way and swapping direction-dependent assertions.
+ *
+ * @param ps Parser holding the tree
+ * @param code Program to emit into
+ * @param n Node index
+ * @param next Instruction to continue at after the node matches
+ * @param reverse Whether to build the reversed program
+ * @return Entry instruction, or -1 if the program grows too large
+ */
+static int compile_node(const parser_t *ps, code_t *code, int n, int next,
+                        bool reverse) {
+  const node_t *node = &ps->nodes[n];
+  switch (node->type) {
+    case N_EMPTY:
+      return next;
+
+    case N_SET:
+      return emit(code, OP_SET, node->arg, next, -1);
+
+    case N_ASSERT: {
+      int kind = node->arg;
+      if (reverse) {
+        if (kind == AS_BOL) kind = AS_EOL;
+        else if (kind == AS_EOL) kind = AS_BOL;
+        else if (kind == AS_WORD_START) kind = AS_WORD_END;
+        else if (kind == AS_WORD_END) kind = AS_WORD_START;
+      }
+      return emit(code, OP_ASSERT, kind, next, -1);
+    }
+
+    case N_CAT: {
+      int count = 0;
+      for (int c = node->child; c >= 0; c = ps->nodes[c].next) count++;
+      int *children = malloc((size_t)(count > 0 ? count : 1) * sizeof(int));
+      if (!children) return -1;
+      int i = 0;
+      for (int c = node->child; c >= 0; c = ps->nodes[c].next) {
+        children[i++] = c;
+      }
+      int entry = next;
+      for (i = 0; i < count && entry >= 0; i++) {
+        int c = reverse ? children[i] : children[count - 1 - i];
+        entry = compile_node(ps, code, c, entry, reverse);
+      }
+      free(children);
+      return entry;
+    }
+
+    case N_ALT: {
+      int entry = -1;
+      for (int c = node->child; c >= 0; c = ps->nodes[c].next) {
+        int branch = compile_node(ps, code, c, next, reverse);
+        if (branch < 0) return -1;
+        entry = entry < 0 ? branch : emit(code, OP_SPLIT, 0, branch, entry);
+        if (entry < 0) return -1;
+      }
+      return entry;
+    }
+
+    case N_REPEAT: {
+      int child = node->child;
+      int entry = next;
+      if (node->max < 0) {
+        /* child*: a split looping back through the child */
+        int loop = emit(code, OP_SPLIT, 0, -1, next);
+        if (loop < 0) return -1;
+        int body = compile_node(ps, code, child, loop, reverse);
+        if (body < 0) return -1;
+        code->insts[loop].out = body;
+        entry = loop;
+      } else {
+        /* Optional copies, nested so each may only follow the last */
+        for (int i = node->min; i < node->max; i++) {
+          int body = compile_node(ps, code, child, entry, reverse);
+          if (body < 0) return -1;
+          entry = emit(code, OP_SPLIT, 0, body, next);
+          if (entry < 0) return -1;
+        }
+      }
+      for (int i = 0; i < node->min; i++) {
+        entry = compile_node(ps, code, child, entry, reverse);
+        if (entry < 0) return -1;
+      }
+      return entry;
+    }
+  }
+  return -1;
+}
+
+
+/**
+ * @brief Compiles the tree into a program ending in MATCH.
+ *
+ * @param ps Parser holding the tree
+ * @param root Root node
+ * @param code Program to fill in
+ * @param reverse Whether to build the reversed program
+ * @return true on success
+ */
+static bool compile_program(const parser_t *ps, int root, code_t *code,
+                            bool reverse) {
+  int match = emit(code, OP_MATCH, 0, -1, -1);
+  if (match < 0) return false;
+  code->start = compile_node(ps, code, root, match, reverse);
+  return code->start >= 0;
+}
+
+
+/**
+ * @brief Splits the 256 byte values into classes no set tells apart.
+ *
+ * Transition tables are indexed by class, which keeps them small.
+ *
+ * @param prog Program whose sets are used
+ */
+static void compute_classes(jbox_regex_prog_t *prog) {
+  memset(prog->class_of, 0, sizeof(prog->class_of));
+  int nclasses = 1;
+
+  byteset_t word = {0};
+  byteset_t nl = {0};
+  for (unsigned b = 0; b < 256; b++) {
+    if (is_word_byte(b)) set_add(&word, b);
+  }
+  set_add(&nl, '\n');
+
+  for (int s = -2; s < prog->nsets; s++) {
+    const byteset_t *set = s == -2 ? &word : s == -1 ? &nl : &prog->sets[s];
+    int remap[512];
+    int n = 0;
+    for (int i = 0; i < 512; i++) remap[i] = -1;
+    for (unsigned b = 0; b < 256; b++) {
+      int key = prog->class_of[b] * 2 + (set_has(set, b) ? 1 : 0);
+      if (remap[key] < 0) remap[key] = n++;
+      prog->class_of[b] = (uint8_t)remap[key];
+    }
+    nclasses = n;
+  }
+
+  prog->nclasses = nclasses;
+  for (int b = 255; b >= 0; b--) {
+    int c = prog->class_of[b];
+    prog->class_rep[c] = (uint8_t)b;
+    prog->class_word[c] = is_word_byte((unsigned)b);
+    prog->class_nl[c] = b == '\n';
+  }
+}
+
+
+// ---------------------------------------------------------------------------
+// Lazy DFA
+// ---------------------------------------------------------------------------
+
+static void dfa_init(dfa_t *dfa, const code_t *code, bool unanchored) {
+  memset(dfa, 0, sizeof(*dfa));
+  dfa->code = code;
+  dfa->unanchored = unanchored;
+  for (int i = 0; i < 4; i++) dfa->start[i] = -1;
+}
+
+
+/**
+ * @brief Drops every cached state.
+ *
+ * @param dfa DFA to flush
+ */
+static void dfa_flush(dfa_t *dfa) {
+  for (int i = 0; i < dfa->count; i++) {
+    free(dfa->states[i].kernel);
+    free(dfa->states[i].next);
+  }
+  dfa->count = 0;
+  if (dfa->slots) {
+    for (int i = 0; i < REGEX_HASH_SLOTS; i++) dfa->slots[i] = -1;
+  }
+  for (int i = 0; i < 4; i++) dfa->start[i] = -1;
+}
+
+
+static void dfa_free(dfa_t *dfa) {
+  dfa_flush(dfa);
+  free(dfa->states);
+  free(dfa->slots);
+}
+
+
+static uint32_t hash_state(const int *kernel, int n, unsigned flags) {
+  uint32_t h = 2166136261u ^ flags;
+  for (int i = 0; i < n; i++) {
+    h = (h ^ (uint32_t)kernel[i]) * 16777619u;
+  }
+  return h;
+}
+
+
+/**
+ * @brief Finds or adds the state for a kernel, flushing a full cache.
+ *
+ * @param prog Program (for the class count)
+ * @param dfa DFA
+ * @param kernel Thread list in canonical order
+ * @param n Length of kernel
+ * @param flags State flags
+ * @param flushed Set to true if the cache was flushed
+ * @return State index, or -1 on allocation failure
+ */
+static int dfa_state(jbox_regex_prog_t *prog, dfa_t *dfa, const int *kernel,
+                     int n, unsigned flags, bool *flushed) {
+  if (!dfa->slots) {
+    dfa->slots = malloc(REGEX_HASH_SLOTS * sizeof(int));
+    if (!dfa->slots) return -1;
+    for (int i = 0; i < REGEX_HASH_SLOTS; i++) dfa->slots[i] = -1;
+  }
+
+  uint32_t h = hash_state(kernel, n, flags);
+  unsigned slot = h & (REGEX_HASH_SLOTS - 1);
+  while (dfa->slots[slot] >= 0) {
+    dfa_state_t *st = &dfa->states[dfa->slots[slot]];
+    if (st->hash == h && st->flags == flags && st->nkernel == n
+        && memcmp(st->kernel, kernel, (size_t)n * sizeof(int)) == 0) {
+      return dfa->slots[slot];
+    }
+    slot = (slot + 1) & (REGEX_HASH_SLOTS - 1);
+  }
+
+  if (dfa->count >= REGEX_MAX_STATES) {
+    dfa_flush(dfa);
+    dfa->flushes++;
+    *flushed = true;
+    slot = h & (REGEX_HASH_SLOTS - 1);
+  }
+  if (dfa->count >= dfa->cap) {
+    int cap = dfa->cap ? dfa->cap * 2 : 16;
+    dfa_state_t *grown = realloc(dfa->states,
+                                 (size_t)cap * sizeof(dfa_state_t));
+    if (!grown) return -1;
+    dfa->states = grown;
+    dfa->cap = cap;
+  }
+
+  dfa_state_t *st = &dfa->states[dfa->count];
+  st->kernel = malloc((size_t)(n > 0 ? n : 1) * sizeof(int));
+  st->next = malloc((size_t)(prog->nclasses + 1) * sizeof(int32_t));
+  if (!st->kernel || !st->next) {
+    free(st->kernel);
+    free(st->next);
+    return -1;
+  }
+  memcpy(st->kernel, kernel, (size_t)n * sizeof(int));
+  memset(st->next, 0xff, (size_t)(prog->nclasses + 1) * sizeof(int32_t));
+  st->nkernel = n;
+  st->flags = flags;
+  st->hash = h;
+
+  dfa->slots[slot] = dfa->count;
+  return dfa->count++;
+}
+
+
+/**
+ * @brief Returns the start state for the given flags.
+ *
+ * @param prog Program
+ * @param dfa DFA
+ * @param flags Kind of the byte before the start position
+ * @return State index, or -1 on allocation failure
+ */
+static int dfa_start(jbox_regex_prog_t *prog, dfa_t *dfa, unsigned flags) {
+  if (dfa->start[flags] >= 0) return dfa->start[flags];
+  bool flushed = false;
+  int kernel = dfa->unanchored ? K_RESTART : dfa->code->start;
+  int id = dfa_state(prog, dfa, &kernel, 1, flags, &flushed);
+  dfa->start[flags] = id;
+  return id;
+}
+
+
+static bool assertion_holds(int kind, unsigned flags,
+                            const jbox_regex_prog_t *prog, int cls) {
+  bool at_end = cls == prog->nclasses
+                || (prog->newline && prog->class_nl[cls]);
+  bool next_word = cls != prog->nclasses && prog->class_word[cls];
+  bool prev_word = (flags & F_WORD) != 0;
+  switch (kind) {
+    case AS_BOL: return (flags & F_START) != 0;
+    case AS_EOL: return at_end;
+    case AS_WORD_BOUNDARY: return prev_word != next_word;
+    case AS_WORD_START: return !prev_word && next_word;
+    default: return prev_word && !next_word;
+  }
+}
+
+
+static int compare_ints(const void *a, const void *b) {
+  int x = *(const int *)a;
+  int y = *(const int *)b;
+  return (x > y) - (x < y);
+}
+
+
+/**
+ * @brief Computes and caches a transition.
+ *
+ * The state's kernel lists threads in priority order, in groups split by
+ * K_MARK: threads of one group started at the same position, and earlier
+ * groups started further left. Each group's empty edges are followed
+ * given the previous byte (from the state) and this one; an instruction
+ * already reached by an earlier group is dropped, since the earlier start
+ * wins. Once a group reaches MATCH, the groups after it (including the
+ * K_RESTART that would start new threads) can only give matches that
+ * start further right and are cut, so the DFA keeps exactly the threads
+ * that can still extend the leftmost match.
+ *
+ * @param prog Program
+ * @param dfa DFA
+ * @param id Current state
+ * @param cls Byte class, or prog->nclasses for the end of text
+ * @return (next state << 1) | matched, or -1 on allocation failure
+ */
+static int32_t dfa_transition(jbox_regex_prog_t *prog, dfa_t *dfa, int id,
+                              int cls) {
+  const code_t *code = dfa->code;
+  const int *kernel = dfa->states[id].kernel;
+  int nkernel = dfa->states[id].nkernel;
+  unsigned flags = dfa->states[id].flags;
+
+  if (++prog->gen == 0) {
+    memset(prog->mark, 0, (size_t)code->count * sizeof(unsigned));
+    memset(prog->seen, 0, (size_t)code->count * sizeof(unsigned));
+    prog->gen = 1;
+  }
+
+  bool at_end = cls == prog->nclasses;
+  unsigned byte = at_end ? 0 : prog->class_rep[cls];
+  bool matched = false;
+  int nlist = 0;
+  int k = 0;
+  while (k < nkernel && !matched) {
+    /* Seed the next group */
+    int sp = 0;
+    bool restart = kernel[k] == K_RESTART;
+    if (restart) {
+      prog->stack[sp++] = code->start;
+      k++;
+    } else {
+      while (k < nkernel && kernel[k] >= 0) {
+        prog->stack[sp++] = kernel[k++];
+      }
+      if (k < nkernel && kernel[k] == K_MARK) k++;
+    }
+
+    int group = nlist + (nlist > 0 ? 1 : 0);
+    int added = 0;
+    while (sp > 0) {
+      int i = prog->stack[--sp];
+      if (prog->mark[i] == prog->gen) continue;
+      prog->mark[i] = prog->gen;
+
+      const inst_t *in = &code->insts[i];
+      switch (in->op) {
+        case OP_SPLIT:
+          prog->stack[sp++] = in->out1;
+          prog->stack[sp++] = in->out;
+          break;
+        case OP_ASSERT:
+          if (assertion_holds(in->arg, flags, prog, cls)) {
+            prog->stack[sp++] = in->out;
+          }
+          break;
+        case OP_MATCH:
+          matched = true;
+          break;
+        default:
+          if (!at_end && set_has(&prog->sets[in->arg], byte)
+              && prog->seen[in->out] != prog->gen) {
+            prog->seen[in->out] = prog->gen;
+            prog->list[group + added++] = in->out;
+          }
+          break;
+      }
+    }
+
+    if (added > 0) {
+      if (group > nlist) prog->list[nlist] = K_MARK;
+      qsort(prog->list + group, (size_t)added, sizeof(int), compare_ints);
+      nlist = group + added;
+    }
+    if (restart && !matched) {
+      if (nlist > 0) prog->list[nlist++] = K_MARK;
+      prog->list[nlist++] = K_RESTART;
+    }
+  }
+
+  if (at_end) {
+    /* End of text: only the match bit matters */
+    int32_t t = ((int32_t)id << 1) | (matched ? 1 : 0);
+    dfa->states[id].next[cls] = t;
+    return t;
+  }
+
+  unsigned next_flags = (prog->class_word[cls] ? F_WORD : 0)
+                        | (prog->newline && prog->class_nl[cls]
+                           ? F_START : 0);
+  bool flushed = false;
+  int next = dfa_state(prog, dfa, prog->list, nlist, next_flags, &flushed);
+  if (next < 0) return -1;
+
+  int32_t t = ((int32_t)next << 1) | (matched ? 1 : 0);
+  if (!flushed) dfa->states[id].next[cls] = t;
+  return t;
+}
+
+
+/**
+ * @brief Steps a DFA over one byte class.
+ *
+ * @param prog Program
+ * @param dfa DFA
+ * @param s Current state
+ * @param cls Byte class, or prog->nclasses for the end of text
+ * @return (next state << 1) | matched, or -1 on allocation failure
+ */
+static inline int32_t dfa_step(jbox_regex_prog_t *prog, dfa_t *dfa, int s,
+                               int cls) {
+  int32_t t = dfa->states[s].next[cls];
+  return t >= 0 ? t : dfa_transition(prog, dfa, s, cls);
+}
+
+
+/**
+ * @brief Checks, after a flush, whether the cache is being rebuilt too
+ *        often to pay off.
+ *
+ * Some patterns (e.g. "a(a|b){20}") need far more states than the cache
+ * holds. Like RE2, give up on the DFA when it cannot scan a fair number
+ * of bytes per state between flushes.
+ *
+ * @param dfa DFA that has just been flushed
+ * @param pos Bytes scanned so far in the current call
+ * @return true if the caller should use the POSIX engine instead
+ */
+static bool dfa_thrashing(dfa_t *dfa, size_t pos) {
+  size_t now = dfa->scanned + pos;
+  bool thrashing = now - dfa->flushed_at < REGEX_MIN_FLUSH_BYTES;
+  dfa->flushed_at = now;
+  return thrashing;
+}
+
+
+/**
+ * @brief Flags describing the byte before a position.
+ *
+ * @param prog Program
+ * @param c The byte, or -1 at the start of text
+ * @return F_* flags
+ */
+static unsigned flags_for(const jbox_regex_prog_t *prog, int c) {
+  if (c < 0) return F_START;
+  return (is_word_byte((unsigned)c) ? F_WORD : 0)
+         | (prog->newline && c == '\n' ? F_START : 0);
+}
+
+
+/**
+ * @brief Finds where the leftmost-longest match ends.
+ *
+ * @param prog Program
+ * @param text Text
+ * @param len Length of text
+ * @param from Offset matches may start at or after
+ * @param first Stop at the first position any match ends at, for callers
+ *        that only need to know whether there is one
+ * @return End offset, -1 if there is no match, -2 if the DFA gave up
+ */
+static long dfa_match_end(jbox_regex_prog_t *prog, const char *text,
+                          size_t len, size_t from, bool first) {
+  dfa_t *dfa = &prog->forward;
+  const unsigned char *p = (const unsigned char *)text;
+  int s = dfa_start(prog, dfa, flags_for(prog, from > 0 ? p[from - 1] : -1));
+  if (s < 0) return -2;
+
+  unsigned flushes = dfa->flushes;
+  long end = -1;
+  size_t i;
+  for (i = from; i < len; i++) {
+    int32_t t = dfa_step(prog, dfa, s, prog->class_of[p[i]]);
+    if (t < 0) return -2;
+    if (dfa->flushes != flushes) {
+      if (dfa_thrashing(dfa, i - from)) return -2;
+      flushes = dfa->flushes;
+    }
+    s = t >> 1;
+    if (t & 1) {
+      end = (long)i;
+      if (first) break;
+    }
+    if (dfa->states[s].nkernel == 0) break;   /* Nothing can follow */
+  }
+  dfa->scanned += i - from;
+
+  if (i == len) {
+    int32_t t = dfa_step(prog, dfa, s, prog->nclasses);
+    if (t < 0) return -2;
+    if (t & 1) end = (long)len;
+  }
+  return end;
+}
+
+
+/**
+ * @brief Finds where the longest match ending at a position starts.
+ *
+ * Runs the reversed program backwards from `end`. Given the end of the
+ * leftmost-longest match, the longest match ending there is that match.
+ *
+ * @param prog Program
+ * @param text Text
+ * @param len Length of text
+ * @param from Lowest offset the match may start at
+ * @param end Position a match is known to end at
+ * @return Start offset, or -2 if the DFA gave up
+ */
+static long dfa_match_start(jbox_regex_prog_t *prog, const char *text,
+                            size_t len, size_t from, size_t end) {
+  dfa_t *dfa = &prog->backward;
+  const unsigned char *p = (const unsigned char *)text;
+  int s = dfa_start(prog, dfa, flags_for(prog, end < len ? p[end] : -1));
+  if (s < 0) return -2;
+
+  unsigned flushes = dfa->flushes;
+  long start = (long)end;
+  size_t i;
+  for (i = end; i > from; i--) {
+    int32_t t = dfa_step(prog, dfa, s, prog->class_of[p[i - 1]]);
+    if (t < 0) return -2;
+    if (dfa->flushes != flushes) {
+      if (dfa_thrashing(dfa, end - i)) return -2;
+      flushes = dfa->flushes;
+    }
+    if (t & 1) start = (long)i;
+    s = t >> 1;
+    if (dfa->states[s].nkernel == 0) break;
+  }
+  dfa->scanned += end - i;
+
+  if (i == from) {
+    /* Only the match bit: the text before `from` is context, not input */
+    int cls = from > 0 ? prog->class_of[p[from - 1]] : prog->nclasses;
+    int32_t t = dfa_step(prog, dfa, s, cls);
+    if (t < 0) return -2;
+    if (t & 1) start = (long)from;
+  }
+  return start;
+}
+
+
+// ---------------------------------------------------------------------------
+// Public interface
+// ---------------------------------------------------------------------------
+
+static void prog_free(jbox_regex_prog_t *prog) {
+  if (!prog) return;
+  dfa_free(&prog->forward);
+  dfa_free(&prog->backward);
+  free(prog->program.insts);
+  free(prog->reversed.insts);
+  free(prog->sets);
+  free(prog->stack);
+  free(prog->list);
+  free(prog->mark);
+  free(prog->seen);
+  free(prog);
+}
+
+
+/**
+ * @brief Builds the DFA program for a pattern.
+ *
+ * @param pattern Pattern text, already accepted by regcomp()
+ * @param cflags regcomp() flags
+ * @return Program, or NULL if the pattern needs the POSIX engine
+ */
+static jbox_regex_prog_t *prog_build(const char *pattern, int cflags) {
+  if ((cflags & ~(REG_EXTENDED | REG_ICASE | REG_NEWLINE)) != 0
+      || !(cflags & REG_EXTENDED)) {
+    return NULL;
+  }
+
+  parser_t ps = {
+    .p = pattern,
+    .icase = (cflags & REG_ICASE) != 0,
+    .newline = (cflags & REG_NEWLINE) != 0,
+    .leading = true,
+  };
+  int root = parse_alt(&ps);
+  jbox_regex_prog_t *prog = NULL;
+  if (root < 0 || *ps.p != '\0') goto done;
+
+  prog = calloc(1, sizeof(*prog));
+  if (!prog) goto done;
+  prog->newline = ps.newline;
+  if (!compile_program(&ps, root, &prog->program, false)
+      || !compile_program(&ps, root, &prog->reversed, true)) {
+    goto fail;
+  }
+
+  prog->sets = ps.sets;
+  prog->nsets = ps.nsets;
+  ps.sets = NULL;
+  compute_classes(prog);
+
+  int insts = prog->program.count > prog->reversed.count
+              ? prog->program.count : prog->reversed.count;
+  prog->stack = malloc(((size_t)insts * 3 + 2) * sizeof(int));
+  prog->list = malloc(((size_t)insts * 2 + 2) * sizeof(int));
+  prog->mark = calloc((size_t)insts, sizeof(unsigned));
+  prog->seen = calloc((size_t)insts, sizeof(unsigned));
+  if (!prog->stack || !prog->list || !prog->mark || !prog->seen) goto fail;
+
+  dfa_init(&prog->forward, &prog->program, true);
+  dfa_init(&prog->backward, &prog->reversed, false);
+  goto done;
+
+fail:
+  prog_free(prog);
+  prog = NULL;
+done:
+  free(ps.nodes);
+  free(ps.sets);
+  return prog;
+}
+
+
+/**
+ * @brief Compiles a pattern for both engines.
+ *
+ * @param re Regex to initialize
+ * @param pattern Pattern text
+ * @param cflags regcomp() flags
+ * @return 0 on success, or the regcomp() error code
+ */
+int jbox_regex_compile(jbox_regex_t *re, const char *pattern, int cflags) {
+  re->prog = NULL;
+  int rc = regcomp(&re->posix, pattern, cflags);
+  if (rc != 0) return rc;
+
+  re->prog = prog_build(pattern, cflags);
+  return 0;
+}
+
+
+/**
+ * @brief Describes a compile error.
+ *
+ * @param errcode Code returned by jbox_regex_compile()
+ * @param re Regex that failed to compile
+ * @param buf Output buffer
+ * @param size Size of buf
+ * @return Size needed for the message
+ */
+size_t jbox_regex_error(int errcode, const jbox_regex_t *re, char *buf,
+                        size_t size) {
+  return regerror(errcode, &re->posix, buf, size);
+}
+
+
+/**
+ * @brief Finds the leftmost-longest match in a buffer.
+ *
+ * @param re Compiled regex
+ * @param text Text to search
+ * @param len Length of text
+ * @param match Set to the match offsets if non-NULL
+ * @return 0 if there is a match, REG_NOMATCH otherwise
+ */
+int jbox_regex_exec(jbox_regex_t *re, const char *text, size_t len,
+                    regmatch_t *match) {
+  return jbox_regex_exec_at(re, text, len, 0, match);
+}
+
+
+/**
+ * @brief Finds the leftmost-longest match starting at or after an offset.
+ *
+ * @param re Compiled regex
+ * @param text Text to search
+ * @param len Length of text
+ * @param from Offset to search from; earlier bytes are only context
+ * @param match Set to the match offsets, relative to text, if non-NULL
+ * @return 0 if there is a match, REG_NOMATCH otherwise
+ */
+int jbox_regex_exec_at(jbox_regex_t *re, const char *text, size_t len,
+                       size_t from, regmatch_t *match) {
+  if (from > len) return REG_NOMATCH;
+
+  jbox_regex_prog_t *prog = re->prog;
+  if (prog) {
+    long end = dfa_match_end(prog, text, len, from, match == NULL);
+    if (end == -1) return REG_NOMATCH;
+    if (end >= 0 && !match) return 0;
+
+    long start = end >= 0 ? dfa_match_start(prog, text, len, from,
+                                            (size_t)end) : -2;
+    if (start >= 0) {
+      match->rm_so = (regoff_t)start;
+      match->rm_eo = (regoff_t)end;
+      return 0;
+    }
+
+    /* Out of memory, or the pattern needs more states than the cache
+     * holds: switch this regex over to POSIX for good */
+    prog_free(prog);
+    re->prog = NULL;
+  }
+
+  regmatch_t m = { .rm_so = (regoff_t)from, .rm_eo = (regoff_t)len };
+  int rc = regexec(&re->posix, text, 1, &m, REG_STARTEND);
+  if (rc == 0 && match) *match = m;
+  return rc == 0 ? 0 : REG_NOMATCH;
+}
+
+
+/**
+ * @brief Reports which engine a regex uses.
+ *
+ * @param re Compiled regex
+ * @return true for the DFA engine
+ */
+bool jbox_regex_is_native(const jbox_regex_t *re) {
+  return re->prog != NULL;
+}
+
+
+/**
+ * @brief Frees a compiled regex.
+ *
+ * @param re Regex to free
+ */
+void jbox_regex_free(jbox_regex_t *re) {
+  prog_free(re->prog);
+  re->prog = NULL;
+  regfree(&re->posix);
+}
@@ -0,0 +1,106 @@
+#ifndef JBOX_REGEX_H
+#define JBOX_REGEX_H
+
+#include <regex.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Compiled program for the DFA engine (private to jbox_regex.c). */
+typedef struct jbox_regex_prog jbox_regex_prog_t;
+
+
+/**
+ * POSIX extended regex with a linear-time DFA engine.
+ *
+ * Patterns are compiled by both regcomp() and a lazily built DFA in the
+ * style of RE2: NFA state sets become DFA states only as the input
+ * reaches them, and each state's transitions are cached, so matching
+ * costs one table lookup per byte and never backtracks. Matches are
+ * leftmost-longest, as with regexec(). Patterns the DFA cannot express
+ * (backreferences, collating elements, assertions inside repeats) run on
+ * the POSIX engine instead.
+ *
+ * The DFA cache is mutated while matching, so a jbox_regex_t must not be
+ * used by two threads at once; compile one per thread instead.
+ */
+typedef struct {
+  regex_t posix;
+  jbox_regex_prog_t *prog;  /**< NULL when matching falls back to POSIX */
+} jbox_regex_t;
+
+
+/**
+ * Compile a pattern.
+ *
+ * @param re Regex to initialize
+ * @param pattern Pattern text
+ * @param cflags regcomp() flags; REG_EXTENDED, REG_ICASE and REG_NEWLINE
+ *        are understood by the DFA, anything else selects POSIX matching
+ * @return 0 on success, or the regcomp() error code (see
+ *         jbox_regex_error()); on error re needs no jbox_regex_free()
+ */
+int jbox_regex_compile(jbox_regex_t *re, const char *pattern, int cflags);
+
+/**
+ * Describe a compile error, like regerror().
+ *
+ * @param errcode Code returned by jbox_regex_compile()
+ * @param re Regex that failed to compile
+ * @param buf Output buffer
+ * @param size Size of buf
+ * @return Size needed for the whole message, including the NUL
+ */
+size_t jbox_regex_error(int errcode, const jbox_regex_t *re, char *buf,
+                        size_t size);
+
+/**
+ * Find the leftmost-longest match in a buffer.
+ *
+ * The buffer is treated as a whole string: position 0 is the start of
+ * text and len its end, and it may contain NUL bytes.
+ *
+ * @param re Compiled regex
+ * @param text Text to search
+ * @param len Length of text
+ * @param match Set to the match offsets if non-NULL; passing NULL only
+ *        answers whether there is a match, which is cheaper
+ * @return 0 if there is a match, REG_NOMATCH otherwise
+ */
+int jbox_regex_exec(jbox_regex_t *re, const char *text, size_t len,
+                    regmatch_t *match);
+
+/**
+ * Find the leftmost-longest match that starts at or after an offset.
+ *
+ * The bytes before `from` are not searched but still decide ^ and word
+ * boundaries at `from`, as with regexec()'s REG_STARTEND, so successive
+ * calls can walk every match in a line.
+ *
+ * @param re Compiled regex
+ * @param text Text to search
+ * @param len Length of text
+ * @param from Offset to search from
+ * @param match Set to the match offsets, relative to text, if non-NULL
+ * @return 0 if there is a match, REG_NOMATCH otherwise
+ */
+int jbox_regex_exec_at(jbox_regex_t *re, const char *text, size_t len,
+                       size_t from, regmatch_t *match);
+
+/**
+ * Whether matching uses the DFA engine rather than POSIX regexec().
+ *
+ * A regex whose DFA keeps outgrowing its state cache switches to POSIX
+ * for good, so this can change from true to false after matching.
+ *
+ * @param re Compiled regex
+ */
+bool jbox_regex_is_native(const jbox_regex_t *re);
+
+/**
+ * Release a compiled regex.
+ *
+ * @param re Regex to free
+ */
+void jbox_regex_free(jbox_regex_t *re);
+
+#endif /* JBOX_REGEX_H */
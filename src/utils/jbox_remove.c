@@ -0,0 +1,280 @@
+/**
+ * @file jbox_remove.c
+ * @brief Parallel directory tree removal for jbox applications.
+ *
+ * Each directory being removed is a node holding an open descriptor and
+ * a count of what is still in progress beneath it: its own scan plus one
+ * per subdirectory handed off. Whoever drops the count to zero closes the
+ * descriptor, removes the directory from its parent with
+ * unlinkat(AT_REMOVEDIR) and drops the parent's count in turn, so the
+ * tree is removed bottom-up without any thread waiting on another.
+ *
+ * Subdirectories are queued for idle workers while the queue is short;
+ * once it holds JBOX_REMOVE_QUEUE_LIMIT nodes they are emptied inline
+ * instead, which keeps the number of open descriptors bounded.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "jbox_ctx.h"
+#include "jbox_remove.h"
+#include "jbox_signals.h"
+
+
+/** Directories queued for workers before the rest are emptied inline */
+#define JBOX_REMOVE_QUEUE_LIMIT 128
+
+/** Upper bound on removal worker threads */
+#define JBOX_REMOVE_MAX_WORKERS 16
+
+
+/** A directory being emptied */
+typedef struct remove_node {
+  struct remove_node *parent;   /* NULL for the top directory */
+  struct remove_node *next;     /* Queue link */
+  int fd;
+  int pending;                  /* Scan plus unfinished subdirectories */
+  char name[];                  /* Name in parent, or the path at the top */
+} remove_node_t;
+
+
+/** Shared state of one removal */
+typedef struct {
+  remove_node_t *queue;         /* LIFO, so work stays near the leaves */
+  size_t queued;
+  int done;                     /* The top directory has been finished */
+  int failed;
+  int first_errno;
+  jbox_ctx_t *ctx;              /* Invocation the removal runs for */
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+} remove_pool_t;
+
+
+/**
+ * Records a failure; only the first one's errno is kept.
+ */
+static void note_error(remove_pool_t *pool, int err) {
+  pthread_mutex_lock(&pool->lock);
+  if (!pool->failed) {
+    pool->failed = 1;
+    pool->first_errno = err;
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+
+/**
+ * Drops one count from a node; the last one removes the directory and
+ * moves on to its parent.
+ */
+static void release_node(remove_pool_t *pool, remove_node_t *node) {
+  while (node) {
+    pthread_mutex_lock(&pool->lock);
+    int left = --node->pending;
+    pthread_mutex_unlock(&pool->lock);
+    if (left > 0) return;
+
+    remove_node_t *parent = node->parent;
+    close(node->fd);
+    int dirfd = parent ? parent->fd : AT_FDCWD;
+    if (unlinkat(dirfd, node->name, AT_REMOVEDIR) != 0 &&
+        errno != ENOENT && !jbox_is_interrupted()) {
+      note_error(pool, errno);
+    }
+    free(node);
+
+    if (!parent) {
+      pthread_mutex_lock(&pool->lock);
+      pool->done = 1;
+      pthread_cond_broadcast(&pool->wake);
+      pthread_mutex_unlock(&pool->lock);
+    }
+    node = parent;
+  }
+}
+
+
+/**
+ * Opens a subdirectory as a new node counting against its parent.
+ * @return The node, or NULL on error (errno set)
+ */
+static remove_node_t *open_node(remove_pool_t *pool, remove_node_t *parent,
+                                const char *name) {
+  int dirfd = parent ? parent->fd : AT_FDCWD;
+  int fd = openat(dirfd, name,
+                  O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd < 0) return NULL;
+
+  size_t len = strlen(name) + 1;
+  remove_node_t *node = malloc(sizeof(*node) + len);
+  if (!node) {
+    close(fd);
+    errno = ENOMEM;
+    return NULL;
+  }
+  node->parent = parent;
+  node->next = NULL;
+  node->fd = fd;
+  node->pending = 1;
+  memcpy(node->name, name, len);
+
+  if (parent) {
+    pthread_mutex_lock(&pool->lock);
+    parent->pending++;
+    pthread_mutex_unlock(&pool->lock);
+  }
+  return node;
+}
+
+
+/**
+ * Removes a node's entries: files directly, subdirectories by queueing
+ * them or, when the queue is long enough, by emptying them here. Drops
+ * the node's scan count when done.
+ */
+static void scan_node(remove_pool_t *pool, remove_node_t *node) {
+  int fd = dup(node->fd);
+  DIR *dir = fd >= 0 ? fdopendir(fd) : NULL;
+  if (!dir) {
+    note_error(pool, errno);
+    if (fd >= 0) close(fd);
+    release_node(pool, node);
+    return;
+  }
+
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (jbox_is_interrupted()) break;
+
+    const char *name = entry->d_name;
+    if (name[0] == '.' &&
+        (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+      continue;
+    }
+
+    int is_dir = entry->d_type == DT_DIR;
+    if (entry->d_type == DT_UNKNOWN) {
+      struct stat st;
+      if (fstatat(node->fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        if (errno != ENOENT) note_error(pool, errno);
+        continue;
+      }
+      is_dir = S_ISDIR(st.st_mode);
+    }
+
+    if (!is_dir) {
+      if (unlinkat(node->fd, name, 0) != 0 && errno != ENOENT) {
+        note_error(pool, errno);
+      }
+      continue;
+    }
+
+    remove_node_t *child = open_node(pool, node, name);
+    if (!child) {
+      if (errno != ENOENT) note_error(pool, errno);
+      continue;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    int queue_it = pool->queued < JBOX_REMOVE_QUEUE_LIMIT;
+    if (queue_it) {
+      child->next = pool->queue;
+      pool->queue = child;
+      pool->queued++;
+      pthread_cond_signal(&pool->wake);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!queue_it) scan_node(pool, child);
+  }
+
+  closedir(dir);
+  release_node(pool, node);
+}
+
+
+/**
+ * Worker thread: empties queued directories until the top one is gone.
+ * @param arg The remove_pool_t
+ * @return NULL
+ */
+static void *remove_worker(void *arg) {
+  remove_pool_t *pool = arg;
+  jbox_ctx_adopt(pool->ctx);
+
+  pthread_mutex_lock(&pool->lock);
+  while (!pool->done) {
+    remove_node_t *node = pool->queue;
+    if (!node) {
+      pthread_cond_wait(&pool->wake, &pool->lock);
+      continue;
+    }
+    pool->queue = node->next;
+    pool->queued--;
+    pthread_mutex_unlock(&pool->lock);
+
+    scan_node(pool, node);
+
+    pthread_mutex_lock(&pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+
+int jbox_remove_tree(const char *path) {
+  struct stat st;
+  if (lstat(path, &st) != 0) return -1;
+  if (!S_ISDIR(st.st_mode)) return unlink(path);
+
+  remove_pool_t pool = { .ctx = jbox_ctx_current() };
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.wake, NULL);
+
+  remove_node_t *top = open_node(&pool, NULL, path);
+  if (!top) {
+    int saved_errno = errno;
+    pthread_cond_destroy(&pool.wake);
+    pthread_mutex_destroy(&pool.lock);
+    errno = saved_errno;
+    return -1;
+  }
+
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int wanted = cores > 1 ? (int)cores - 1 : 0;   /* This thread works too */
+  if (wanted > JBOX_REMOVE_MAX_WORKERS - 1) {
+    wanted = JBOX_REMOVE_MAX_WORKERS - 1;
+  }
+  pthread_t threads[JBOX_REMOVE_MAX_WORKERS];
+  int started = 0;
+  for (int i = 0; i < wanted; i++) {
+    if (pthread_create(&threads[i], NULL, remove_worker, &pool) != 0) break;
+    started++;
+  }
+
+  scan_node(&pool, top);
+  remove_worker(&pool);
+
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  pthread_cond_destroy(&pool.wake);
+  pthread_mutex_destroy(&pool.lock);
+
+  if (jbox_is_interrupted()) return -2;
+  if (pool.failed) {
+    errno = pool.first_errno;
+    return -1;
+  }
+  return 0;
+}
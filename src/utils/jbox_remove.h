@@ -0,0 +1,20 @@
+#ifndef JBOX_REMOVE_H
+#define JBOX_REMOVE_H
+
+/**
+ * Remove a file or a whole directory tree, like rm -rf on one path.
+ *
+ * Directories are read through their own descriptors and their entries
+ * removed with unlinkat() relative to them, so no path is resolved from
+ * the top more than once. Separate subdirectories are emptied in
+ * parallel on a pool of threads. Symlinks are removed, never followed.
+ * An entry that cannot be removed does not stop the rest of the tree
+ * from being removed.
+ *
+ * @param path File or directory to remove
+ * @return 0 on success, -1 on error (errno set to the first failure's),
+ *         -2 on interrupt
+ */
+int jbox_remove_tree(const char *path);
+
+#endif /* JBOX_REMOVE_H */
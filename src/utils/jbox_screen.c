@@ -0,0 +1,357 @@
+/**
+ * @file jbox_screen.c
+ * @brief Differential terminal renderer for jbox applications.
+ *
+ * The renderer keeps two grids of cells: the back buffer the application
+ * draws into and the front buffer holding what the terminal shows. A
+ * flush walks the rows, skips cells that are unchanged, and for each run
+ * of changes emits a cursor move (or rewrites a short unchanged gap when
+ * that is cheaper), the attribute changes and the characters. A row whose
+ * old contents reach past its new ones is finished with erase-to-end-of-
+ * line. Everything for a frame is collected in one buffer and written
+ * with as few write() calls as the terminal accepts, normally one.
+ *
+ * A cell holds one UTF-8 character and is taken to be one column wide;
+ * the applications drawing through it show text files, where that holds
+ * for almost everything, and a wide character only shifts the rest of
+ * its own row.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "jbox_screen.h"
+
+
+/** Unchanged cells rewritten rather than moving the cursor past them */
+#define JBOX_SCREEN_MAX_GAP 4
+
+
+/** One character cell */
+typedef struct {
+  char ch[4];                 /* UTF-8 bytes, zero padded */
+  uint8_t len;
+  uint8_t attr;
+} screen_cell_t;
+
+struct jbox_screen {
+  int fd;
+  int rows;
+  int cols;
+  screen_cell_t *back;        /* What the application drew */
+  screen_cell_t *front;       /* What the terminal shows */
+  int valid;                  /* Whether front matches the terminal */
+  int cursor_row;             /* Where the cursor is left, -1 hidden */
+  int cursor_col;
+  char *out;                  /* Bytes of the frame being flushed */
+  size_t out_len;
+  size_t out_cap;
+  int out_error;              /* errno of a failed write, or 0 */
+};
+
+static const screen_cell_t blank_cell = { .ch = " ", .len = 1, .attr = 0 };
+
+
+/**
+ * Sets every cell in cells[0, n) to a blank.
+ */
+static void fill_blank(screen_cell_t *cells, size_t n) {
+  for (size_t i = 0; i < n; i++) cells[i] = blank_cell;
+}
+
+
+/**
+ * Compares two cells; the padding of ch is always zero.
+ */
+static int cell_eq(const screen_cell_t *a, const screen_cell_t *b) {
+  return memcmp(a, b, sizeof(*a)) == 0;
+}
+
+
+/**
+ * Returns the number of columns of a row up to its last non-blank cell.
+ */
+static int used_width(const screen_cell_t *row, int cols) {
+  while (cols > 0 && cell_eq(&row[cols - 1], &blank_cell)) cols--;
+  return cols;
+}
+
+
+/**
+ * Writes all of buf to fd, retrying on EINTR and short writes.
+ * @return 0 on success, -1 on error (errno set)
+ */
+static int write_all(int fd, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    buf += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+
+/**
+ * Appends bytes to the frame. If the buffer cannot grow, what is queued
+ * is written out first, so an allocation failure costs calls, not output.
+ */
+static void out_bytes(jbox_screen_t *screen, const char *p, size_t n) {
+  if (screen->out_len + n > screen->out_cap) {
+    size_t cap = screen->out_cap ? screen->out_cap : 4096;
+    while (cap < screen->out_len + n) cap *= 2;
+    char *out = realloc(screen->out, cap);
+    if (out) {
+      screen->out = out;
+      screen->out_cap = cap;
+    } else {
+      if (write_all(screen->fd, screen->out, screen->out_len) != 0 &&
+          !screen->out_error) {
+        screen->out_error = errno;
+      }
+      screen->out_len = 0;
+      if (n > screen->out_cap) {
+        if (write_all(screen->fd, p, n) != 0 && !screen->out_error) {
+          screen->out_error = errno;
+        }
+        return;
+      }
+    }
+  }
+  memcpy(screen->out + screen->out_len, p, n);
+  screen->out_len += n;
+}
+
+
+static void out_str(jbox_screen_t *screen, const char *s) {
+  out_bytes(screen, s, strlen(s));
+}
+
+
+/**
+ * Appends a cursor move to a 0-based position.
+ */
+static void out_move(jbox_screen_t *screen, int row, int col) {
+  char buf[32];
+  int len = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", row + 1, col + 1);
+  out_bytes(screen, buf, (size_t)len);
+}
+
+
+/**
+ * Appends an attribute change if attr differs from the current one.
+ */
+static void out_attr(jbox_screen_t *screen, int *current, int attr) {
+  if (*current == attr) return;
+  out_str(screen, attr & JBOX_SCREEN_REVERSE ? "\x1b[0;7m" : "\x1b[0m");
+  *current = attr;
+}
+
+
+/**
+ * Returns the length of the printable UTF-8 character at text, or 0 for
+ * a control character or a byte that does not start a valid sequence.
+ */
+static size_t char_len(const unsigned char *text, size_t avail) {
+  unsigned char c = text[0];
+  if (c < 0x20 || c == 0x7f) return 0;
+  if (c < 0x80) return 1;
+
+  size_t n;
+  if (c >= 0xc2 && c <= 0xdf) n = 2;
+  else if (c >= 0xe0 && c <= 0xef) n = 3;
+  else if (c >= 0xf0 && c <= 0xf4) n = 4;
+  else return 0;
+  if (n > avail) return 0;
+  for (size_t i = 1; i < n; i++) {
+    if ((text[i] & 0xc0) != 0x80) return 0;
+  }
+  /* U+0080 to U+009F are C1 controls */
+  if (c == 0xc2 && text[1] < 0xa0) return 0;
+  return n;
+}
+
+
+jbox_screen_t *jbox_screen_new(int fd, int rows, int cols) {
+  jbox_screen_t *screen = calloc(1, sizeof(*screen));
+  if (!screen) return NULL;
+  screen->fd = fd;
+  screen->cursor_row = -1;
+  if (jbox_screen_resize(screen, rows, cols) != 0) {
+    free(screen);
+    return NULL;
+  }
+  return screen;
+}
+
+
+void jbox_screen_free(jbox_screen_t *screen) {
+  if (!screen) return;
+  free(screen->back);
+  free(screen->front);
+  free(screen->out);
+  free(screen);
+}
+
+
+int jbox_screen_resize(jbox_screen_t *screen, int rows, int cols) {
+  if (rows < 1) rows = 1;
+  if (cols < 1) cols = 1;
+  size_t n = (size_t)rows * (size_t)cols;
+  screen_cell_t *back = malloc(n * sizeof(*back));
+  screen_cell_t *front = malloc(n * sizeof(*front));
+  if (!back || !front) {
+    free(back);
+    free(front);
+    return -1;
+  }
+  fill_blank(back, n);
+  free(screen->back);
+  free(screen->front);
+  screen->back = back;
+  screen->front = front;
+  screen->rows = rows;
+  screen->cols = cols;
+  screen->valid = 0;
+  return 0;
+}
+
+
+void jbox_screen_invalidate(jbox_screen_t *screen) {
+  screen->valid = 0;
+}
+
+
+void jbox_screen_clear(jbox_screen_t *screen) {
+  fill_blank(screen->back, (size_t)screen->rows * (size_t)screen->cols);
+}
+
+
+void jbox_screen_clear_row(jbox_screen_t *screen, int row) {
+  if (row < 0 || row >= screen->rows) return;
+  fill_blank(screen->back + (size_t)row * (size_t)screen->cols,
+             (size_t)screen->cols);
+}
+
+
+int jbox_screen_put(jbox_screen_t *screen, int row, int col, const char *text,
+                    size_t len, int attr) {
+  if (row < 0 || row >= screen->rows || col < 0) return col;
+  screen_cell_t *line = screen->back + (size_t)row * (size_t)screen->cols;
+  const unsigned char *p = (const unsigned char *)text;
+  size_t i = 0;
+
+  while (i < len && col < screen->cols) {
+    if (p[i] == '\t') {
+      do {
+        line[col] = blank_cell;
+        line[col++].attr = (uint8_t)attr;
+      } while (col % 8 != 0 && col < screen->cols);
+      i++;
+      continue;
+    }
+
+    screen_cell_t *cell = &line[col++];
+    memset(cell->ch, 0, sizeof(cell->ch));
+    size_t n = char_len(p + i, len - i);
+    if (n == 0) {
+      cell->ch[0] = '?';
+      n = 1;
+    } else {
+      memcpy(cell->ch, p + i, n);
+    }
+    cell->len = (uint8_t)n;
+    cell->attr = (uint8_t)attr;
+    i += n;
+  }
+  return col;
+}
+
+
+void jbox_screen_set_cursor(jbox_screen_t *screen, int row, int col) {
+  screen->cursor_row = row;
+  screen->cursor_col = col;
+}
+
+
+int jbox_screen_flush(jbox_screen_t *screen) {
+  int cols = screen->cols;
+  int cur_row = -1;           /* Terminal cursor; -1 when unknown */
+  int cur_col = 0;
+  int attr = 0;
+
+  screen->out_len = 0;
+  screen->out_error = 0;
+  out_str(screen, "\x1b[?25l");
+  if (!screen->valid) {
+    out_str(screen, "\x1b[0m\x1b[H\x1b[2J");
+    fill_blank(screen->front, (size_t)screen->rows * (size_t)cols);
+    cur_row = 0;
+    cur_col = 0;
+    screen->valid = 1;
+  }
+
+  for (int r = 0; r < screen->rows; r++) {
+    screen_cell_t *back = screen->back + (size_t)r * (size_t)cols;
+    screen_cell_t *front = screen->front + (size_t)r * (size_t)cols;
+    int back_end = used_width(back, cols);
+    int front_end = used_width(front, cols);
+
+    for (int c = 0; c < back_end; c++) {
+      if (cell_eq(&back[c], &front[c])) continue;
+      if (cur_row != r || cur_col > c ||
+          c - cur_col > JBOX_SCREEN_MAX_GAP) {
+        out_move(screen, r, c);
+        cur_row = r;
+        cur_col = c;
+      }
+      /* Cells before c in the gap are unchanged, rewriting them is safe */
+      for (; cur_col <= c; cur_col++) {
+        out_attr(screen, &attr, back[cur_col].attr);
+        out_bytes(screen, back[cur_col].ch, back[cur_col].len);
+      }
+      /* Terminals differ on where the cursor is after the last column */
+      if (cur_col == cols) cur_row = -1;
+    }
+
+    if (front_end > back_end) {
+      if (cur_row != r || cur_col != back_end) out_move(screen, r, back_end);
+      out_attr(screen, &attr, 0);
+      out_str(screen, "\x1b[K");
+      cur_row = r;
+      cur_col = back_end;
+    }
+    memcpy(front, back, (size_t)cols * sizeof(*front));
+  }
+
+  out_attr(screen, &attr, 0);
+  if (screen->cursor_row >= 0 && screen->cursor_row < screen->rows) {
+    int col = screen->cursor_col;
+    if (col >= cols) col = cols - 1;
+    if (col < 0) col = 0;
+    out_move(screen, screen->cursor_row, col);
+    out_str(screen, "\x1b[?25h");
+  }
+
+  if (write_all(screen->fd, screen->out, screen->out_len) != 0 &&
+      !screen->out_error) {
+    screen->out_error = errno;
+  }
+  screen->out_len = 0;
+  if (screen->out_error) {
+    /* Whatever reached the terminal, repaint it all next time */
+    screen->valid = 0;
+    errno = screen->out_error;
+    return -1;
+  }
+  return 0;
+}
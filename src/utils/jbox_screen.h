@@ -0,0 +1,111 @@
+#ifndef JBOX_SCREEN_H
+#define JBOX_SCREEN_H
+
+#include <stddef.h>
+
+/** Cell attribute: reverse video */
+#define JBOX_SCREEN_REVERSE 0x01
+
+/** Terminal renderer, private to jbox_screen.c. */
+typedef struct jbox_screen jbox_screen_t;
+
+
+/**
+ * Create a renderer for a full-screen terminal application.
+ *
+ * Drawing goes into a back buffer of character cells. A flush compares
+ * it with what the terminal showed after the last flush and sends only
+ * the cells that changed, with cursor motion between them, in a single
+ * write(). Scrolling one line or updating a status field then costs a
+ * few bytes instead of a repaint of the whole screen.
+ *
+ * All output to the terminal must go through the renderer, or the
+ * screen must be invalidated afterwards.
+ *
+ * @param fd Descriptor of the terminal to draw on
+ * @param rows Number of rows
+ * @param cols Number of columns
+ * @return The renderer, or NULL if out of memory
+ */
+jbox_screen_t *jbox_screen_new(int fd, int rows, int cols);
+
+/**
+ * Free a renderer. The terminal is left as it is.
+ *
+ * @param screen Renderer to free; NULL is ignored
+ */
+void jbox_screen_free(jbox_screen_t *screen);
+
+/**
+ * Change the screen size and clear the back buffer. The next flush
+ * repaints everything.
+ *
+ * @param screen Renderer
+ * @param rows Number of rows
+ * @param cols Number of columns
+ * @return 0 on success, -1 if out of memory (the old size is kept)
+ */
+int jbox_screen_resize(jbox_screen_t *screen, int rows, int cols);
+
+/**
+ * Forget what the terminal shows, so that the next flush clears it and
+ * repaints everything; for after the screen was disturbed, e.g. by a
+ * suspend.
+ *
+ * @param screen Renderer
+ */
+void jbox_screen_invalidate(jbox_screen_t *screen);
+
+/**
+ * Blank every cell of the back buffer.
+ *
+ * @param screen Renderer
+ */
+void jbox_screen_clear(jbox_screen_t *screen);
+
+/**
+ * Blank one row of the back buffer.
+ *
+ * @param screen Renderer
+ * @param row Row, from 0; out of range rows are ignored
+ */
+void jbox_screen_clear_row(jbox_screen_t *screen, int row);
+
+/**
+ * Write text into the back buffer, clipped to the row.
+ *
+ * Each UTF-8 character takes one cell. Tabs are expanded to the next
+ * multiple of 8 columns, and other control characters and invalid bytes
+ * are shown as '?', so what the terminal shows always matches the
+ * cells.
+ *
+ * @param screen Renderer
+ * @param row Row, from 0
+ * @param col Column to start at, from 0
+ * @param text Text, not necessarily NUL-terminated
+ * @param len Length of text in bytes
+ * @param attr JBOX_SCREEN_* attributes for the cells written
+ * @return The column after the text, or the screen width if it was
+ *         clipped
+ */
+int jbox_screen_put(jbox_screen_t *screen, int row, int col, const char *text,
+                    size_t len, int attr);
+
+/**
+ * Set where the cursor is left after a flush.
+ *
+ * @param screen Renderer
+ * @param row Row, from 0, or -1 to hide the cursor
+ * @param col Column, from 0
+ */
+void jbox_screen_set_cursor(jbox_screen_t *screen, int row, int col);
+
+/**
+ * Send the changes since the last flush to the terminal.
+ *
+ * @param screen Renderer
+ * @return 0 on success, -1 on write error (errno set)
+ */
+int jbox_screen_flush(jbox_screen_t *screen);
+
+#endif /* JBOX_SCREEN_H */
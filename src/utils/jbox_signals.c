@@ -3,20 +3,19 @@
  * @brief Signal handling utilities for jbox applications.
  *
  * Provides a simple SIGINT handler and interrupt checking utilities
- * for graceful handling of Ctrl-C in command-line applications.
+ * for graceful handling of Ctrl-C in command-line applications. The
+ * checks read the flag of the current jbox_ctx_t, which is the process
+ * flag below for a standalone app and the host's choice otherwise.
  */
 
 #include <signal.h>
 #include <stdbool.h>
 #include <stddef.h>
 
+#include "jbox_ctx.h"
 #include "jbox_signals.h"
 
 
-/** Global flag indicating whether SIGINT was received. */
-volatile sig_atomic_t jbox_interrupted = 0;
-
-
 /**
  * @brief SIGINT signal handler.
  *
@@ -36,10 +35,15 @@ static void jbox_sigint_handler(int sig) {
  *
  * Sets up the signal handler to catch Ctrl-C interrupts.
  * Does not use SA_RESTART, so system calls will return EINTR.
+ * Leaves the host's handler alone when running under a host context.
  */
 void jbox_setup_sigint_handler(void) {
   struct sigaction sa;
 
+  if (jbox_ctx_is_hosted()) {
+    return;
+  }
+
   sa.sa_handler = jbox_sigint_handler;
   sigemptyset(&sa.sa_mask);
   sa.sa_flags = 0;  /* Don't use SA_RESTART - let syscalls return EINTR */
@@ -51,26 +55,34 @@ void jbox_setup_sigint_handler(void) {
 /**
  * @brief Checks and clears the interrupt flag.
  *
- * Atomically checks if SIGINT was received and clears the flag.
+ * Atomically checks if SIGINT was received and clears the flag. A host's
+ * cancellation of the invocation also counts, and stays set.
  *
  * @return true if interrupt was pending, false otherwise.
  */
 bool jbox_check_interrupted(void) {
-  if (jbox_interrupted) {
-    jbox_interrupted = 0;
+  jbox_ctx_t *ctx = jbox_ctx_current();
+  volatile sig_atomic_t *flag = ctx->interrupted;
+
+  if (*flag) {
+    *flag = 0;
     return true;
   }
-  return false;
+  /* Cancellation is not cleared: the app is expected to stop */
+  return ctx->cancelled != NULL && atomic_load(ctx->cancelled);
 }
 
 
 /**
  * @brief Checks the interrupt flag without clearing it.
  *
- * @return true if SIGINT was received, false otherwise.
+ * @return true if SIGINT was received or the host cancelled the
+ *         invocation, false otherwise.
  */
 bool jbox_is_interrupted(void) {
-  return jbox_interrupted != 0;
+  jbox_ctx_t *ctx = jbox_ctx_current();
+  return *ctx->interrupted != 0
+         || (ctx->cancelled != NULL && atomic_load(ctx->cancelled));
 }
 
 
@@ -80,5 +92,5 @@ bool jbox_is_interrupted(void) {
  * Resets the SIGINT flag to allow detecting future interrupts.
  */
 void jbox_clear_interrupted(void) {
-  jbox_interrupted = 0;
+  *jbox_ctx_current()->interrupted = 0;
 }
@@ -5,8 +5,9 @@
 #include <stdbool.h>
 
 /**
- * Global flag set by SIGINT handler.
- * Apps can check this to detect if they should abort.
+ * Global flag set by SIGINT handler, defined in jbox_ctx.c.
+ * It is the interrupt flag of standalone apps; apps should use the
+ * functions below, which follow the current jbox_ctx_t.
  */
 extern volatile sig_atomic_t jbox_interrupted;
 
@@ -14,19 +15,21 @@ extern volatile sig_atomic_t jbox_interrupted;
  * Set up a simple SIGINT handler for standalone apps.
  * The handler sets jbox_interrupted = 1 when SIGINT is received.
  * Should be called early in main() for apps that need interruptibility.
+ * Does nothing under a host context, whose host handles signals.
  */
 void jbox_setup_sigint_handler(void);
 
 /**
  * Check if the app was interrupted and clear the flag.
- * Returns true if SIGINT was received since last check.
+ * Returns true if SIGINT was received since last check, or if the host
+ * cancelled the invocation (e.g. nothing reads its output any more).
  *
  * @return true if interrupted, false otherwise
  */
 bool jbox_check_interrupted(void);
 
 /**
- * Check if the app was interrupted without clearing the flag.
+ * Check if the app was interrupted or cancelled without clearing the flag.
  * Useful for checking in loops where you want to preserve the state.
  *
  * @return true if interrupted, false otherwise
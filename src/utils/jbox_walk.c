@@ -0,0 +1,744 @@
+/**
+ * @file jbox_walk.c
+ * @brief Parallel directory tree walker shared by find, rg and cp.
+ *
+ * Every directory still to be read is a node holding its open descriptor
+ * and its path. Reading a node visits its entries and opens each
+ * subdirectory to visit as a new node, which goes on a shared LIFO queue
+ * for whichever thread is idle; once the queue holds
+ * JBOX_WALK_QUEUE_LIMIT nodes, subdirectories are read inline instead,
+ * which bounds the number of open descriptors. The walk is over when the
+ * queue is empty and no thread is reading.
+ *
+ * A node also counts what is unfinished beneath it: its own reading plus
+ * one per subdirectory opened. Whoever drops the count to zero leaves the
+ * directory and drops its parent's count in turn, as jbox_remove does, so
+ * directories are left bottom-up without any thread waiting on another.
+ *
+ * .gitignore rules are kept as a chain of immutable, reference-counted
+ * links, one per directory that has a .gitignore, so a node only holds a
+ * pointer to the rules in effect above it and threads never copy them.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "jbox_ctx.h"
+#include "jbox_signals.h"
+#include "jbox_walk.h"
+
+
+/** Bytes requested per getdents64 call */
+#define JBOX_WALK_DIRENT_BUF_SIZE (32 * 1024)
+
+/** Directories queued for workers before the rest are read inline */
+#define JBOX_WALK_QUEUE_LIMIT 128
+
+/** Largest .gitignore that is read; the rest of a bigger file is ignored */
+#define JBOX_WALK_MAX_IGNORE_FILE (1024 * 1024)
+
+
+/** Record layout returned by getdents64 */
+struct walk_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+
+/** One pattern from a .gitignore */
+typedef struct {
+  char *pattern;
+  size_t base_len;      /* Length of the owning directory's relative path */
+  bool negate;          /* "!pattern" re-includes */
+  bool dir_only;        /* "pattern/" matches directories only */
+  bool anchored;        /* Contains '/', so matched against the path */
+  bool deep;            /* Contains "**", so '*' may cross '/' */
+} ignore_rule_t;
+
+
+/** Rules of one .gitignore, linked to those of the directories above */
+typedef struct walk_rules {
+  struct walk_rules *parent;
+  atomic_int refs;
+  size_t count;
+  ignore_rule_t *rules;
+} walk_rules_t;
+
+
+/** A directory waiting to be read, or with subdirectories unfinished */
+typedef struct walk_node {
+  struct walk_node *parent;     /* NULL for the root */
+  struct walk_node *next;       /* Queue link */
+  walk_rules_t *rules;          /* Rules in effect; one reference held */
+  void *data;                   /* From the visitor, for the leave callback */
+  atomic_int pending;           /* Reading plus unfinished subdirectories */
+  int fd;
+  int depth;
+  size_t len;
+  char path[];
+} walk_node_t;
+
+
+/** Shared state of one walk */
+typedef struct {
+  walk_node_t *queue;           /* LIFO, so work stays near the leaves */
+  size_t queued;
+  size_t outstanding;           /* Queued plus being read */
+  int done;
+  atomic_bool stopped;          /* A visitor said stop, or memory ran out */
+  int out_of_memory;
+  int flags;
+  int max_depth;
+  size_t rel_start;             /* Offset of rel within an entry's path */
+  jbox_walk_visit_fn visit;
+  jbox_walk_error_fn error;
+  jbox_walk_leave_fn leave;
+  void *arg;
+  jbox_ctx_t *ctx;              /* Invocation the walk runs for */
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+} walk_pool_t;
+
+
+/**
+ * Takes another reference to a rule chain.
+ * @param rules Chain, or NULL
+ * @return rules
+ */
+static walk_rules_t *rules_ref(walk_rules_t *rules) {
+  if (rules) atomic_fetch_add(&rules->refs, 1);
+  return rules;
+}
+
+
+/**
+ * Drops a reference to a rule chain, freeing the links nobody holds.
+ * @param rules Chain, or NULL
+ */
+static void rules_release(walk_rules_t *rules) {
+  while (rules && atomic_fetch_sub(&rules->refs, 1) == 1) {
+    walk_rules_t *parent = rules->parent;
+    for (size_t i = 0; i < rules->count; i++) {
+      free(rules->rules[i].pattern);
+    }
+    free(rules->rules);
+    free(rules);
+    rules = parent;
+  }
+}
+
+
+/**
+ * Parses one .gitignore line into a rule.
+ * @param line Line text, modified in place
+ * @param base_len Length of the relative path of the .gitignore's directory
+ * @param rule Rule to fill in
+ * @return true if the line holds a pattern
+ */
+static bool parse_ignore_line(char *line, size_t base_len,
+                              ignore_rule_t *rule) {
+  size_t len = strlen(line);
+  if (len > 0 && line[len - 1] == '\r') line[--len] = '\0';
+  while (len > 0 && line[len - 1] == ' '
+         && (len < 2 || line[len - 2] != '\\')) {
+    line[--len] = '\0';
+  }
+  if (len == 0 || line[0] == '#') return false;
+
+  memset(rule, 0, sizeof(*rule));
+  rule->base_len = base_len;
+
+  char *pat = line;
+  if (*pat == '!') {
+    rule->negate = true;
+    pat++;
+  } else if (*pat == '\\') {
+    pat++;              /* "\#" and "\!" start literal patterns */
+  }
+
+  len = strlen(pat);
+  if (len >= 3 && strcmp(pat + len - 3, "/**") == 0) {
+    pat[len - 3] = '\0';  /* Everything inside: skip the directory */
+    rule->dir_only = true;
+    len -= 3;
+  }
+  if (len > 0 && pat[len - 1] == '/') {
+    pat[--len] = '\0';
+    rule->dir_only = true;
+  }
+  while (strncmp(pat, "**/", 3) == 0) {
+    pat += 3;           /* Leading "**" matches in any directory */
+  }
+  if (*pat == '/') {
+    rule->anchored = true;
+    pat++;
+  }
+  if (*pat == '\0') return false;
+
+  if (strchr(pat, '/')) rule->anchored = true;
+  rule->deep = strstr(pat, "**") != NULL;
+  rule->pattern = strdup(pat);
+  return rule->pattern != NULL;
+}
+
+
+/**
+ * Reads a directory's .gitignore into a new link of the rule chain.
+ * @param dir_fd Descriptor of the directory
+ * @param base_len Length of the directory's path relative to the root,
+ *        its trailing '/' included
+ * @param parent Rules in effect above; the new link takes over this
+ *        reference
+ * @return The new link, or NULL if there is no .gitignore with patterns
+ *         (errno 0) or on allocation failure (errno ENOMEM)
+ */
+static walk_rules_t *load_gitignore(int dir_fd, size_t base_len,
+                                    walk_rules_t *parent) {
+  errno = 0;
+  int fd = openat(dir_fd, ".gitignore", O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    errno = 0;
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    errno = 0;
+    return NULL;
+  }
+
+  size_t size = (size_t)st.st_size;
+  if (size > JBOX_WALK_MAX_IGNORE_FILE) size = JBOX_WALK_MAX_IGNORE_FILE;
+  char *content = malloc(size + 1);
+  walk_rules_t *link = calloc(1, sizeof(*link));
+  if (!content || !link) {
+    free(content);
+    free(link);
+    close(fd);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  size_t got = 0;
+  while (got < size) {
+    ssize_t n = read(fd, content + got, size - got);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    got += (size_t)n;
+  }
+  close(fd);
+  content[got] = '\0';
+
+  size_t capacity = 0;
+  int failed = 0;
+  char *save = NULL;
+  for (char *line = strtok_r(content, "\n", &save); line;
+       line = strtok_r(NULL, "\n", &save)) {
+    ignore_rule_t rule;
+    if (!parse_ignore_line(line, base_len, &rule)) continue;
+
+    if (link->count >= capacity) {
+      size_t new_cap = capacity == 0 ? 32 : capacity * 2;
+      ignore_rule_t *grown = realloc(link->rules,
+                                     new_cap * sizeof(ignore_rule_t));
+      if (!grown) {
+        free(rule.pattern);
+        failed = 1;
+        break;
+      }
+      link->rules = grown;
+      capacity = new_cap;
+    }
+    link->rules[link->count++] = rule;
+  }
+  free(content);
+
+  if (failed || link->count == 0) {
+    for (size_t i = 0; i < link->count; i++) free(link->rules[i].pattern);
+    free(link->rules);
+    free(link);
+    errno = failed ? ENOMEM : 0;
+    return NULL;
+  }
+
+  link->parent = parent;
+  atomic_init(&link->refs, 1);
+  return link;
+}
+
+
+/**
+ * Checks an entry against the .gitignore rules in effect.
+ *
+ * As in git, the last matching rule decides, so a later "!pattern"
+ * re-includes something an earlier pattern excluded, and a deeper
+ * .gitignore overrides the ones above it.
+ *
+ * @param rules Rule chain, innermost link first
+ * @param rel Path of the entry relative to the walk root
+ * @param name Entry name
+ * @param is_dir Whether the entry is a directory
+ * @return true if the entry should be skipped
+ */
+static bool is_ignored(const walk_rules_t *rules, const char *rel,
+                       const char *name, bool is_dir) {
+  for (; rules; rules = rules->parent) {
+    for (size_t i = rules->count; i > 0; i--) {
+      const ignore_rule_t *rule = &rules->rules[i - 1];
+      if (rule->dir_only && !is_dir) continue;
+
+      int rc;
+      if (rule->anchored) {
+        rc = fnmatch(rule->pattern, rel + rule->base_len,
+                     rule->deep ? 0 : FNM_PATHNAME);
+      } else {
+        rc = fnmatch(rule->pattern, name, 0);
+      }
+      if (rc == 0) return !rule->negate;
+    }
+  }
+  return false;
+}
+
+
+/**
+ * Whether the walk should wind down.
+ */
+static bool should_stop(walk_pool_t *pool) {
+  return atomic_load(&pool->stopped) || jbox_is_interrupted();
+}
+
+
+/**
+ * Records that memory ran out and stops the walk.
+ */
+static void note_out_of_memory(walk_pool_t *pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->out_of_memory = 1;
+  pthread_mutex_unlock(&pool->lock);
+  atomic_store(&pool->stopped, true);
+}
+
+
+/**
+ * Reports an entry or directory the walk has to leave out.
+ */
+static void report(walk_pool_t *pool, const char *path, int err) {
+  if (pool->error && !jbox_is_interrupted()) {
+    pool->error(path, err, pool->arg);
+  }
+}
+
+
+/**
+ * Leaves a directory, if its visitor gave it data.
+ */
+static void leave(walk_pool_t *pool, void *data) {
+  if (pool->leave && data) pool->leave(data, pool->arg);
+}
+
+
+/**
+ * Drops one count from a node; the last one leaves the directory, frees
+ * the node and moves on to its parent.
+ */
+static void release_node(walk_pool_t *pool, walk_node_t *node) {
+  while (node && atomic_fetch_sub(&node->pending, 1) == 1) {
+    walk_node_t *parent = node->parent;
+    leave(pool, node->data);
+    free(node);
+    node = parent;
+  }
+}
+
+
+/**
+ * Makes a node for a directory opened as fd.
+ * @return The node, or NULL if out of memory (fd is closed)
+ */
+static walk_node_t *new_node(walk_node_t *parent, int fd, const char *path,
+                             size_t len, int depth, walk_rules_t *rules,
+                             void *data) {
+  walk_node_t *node = malloc(sizeof(*node) + len + 1);
+  if (!node) {
+    close(fd);
+    errno = ENOMEM;
+    return NULL;
+  }
+  node->parent = parent;
+  node->next = NULL;
+  node->rules = rules_ref(rules);
+  node->data = data;
+  atomic_init(&node->pending, 1);
+  node->fd = fd;
+  node->depth = depth;
+  node->len = len;
+  memcpy(node->path, path, len);
+  node->path[len] = '\0';
+  if (parent) atomic_fetch_add(&parent->pending, 1);
+  return node;
+}
+
+
+/**
+ * Opens a subdirectory as a new node counting against its parent.
+ * @param parent Node being read
+ * @param name Name in the parent
+ * @param path Full path, len bytes long
+ * @param rules Rules in effect inside it; a new reference is taken
+ * @param data From the subdirectory's visitor
+ * @return The node, or NULL on error (errno set)
+ */
+static walk_node_t *open_node(walk_pool_t *pool, walk_node_t *parent,
+                              const char *name, const char *path, size_t len,
+                              int depth, walk_rules_t *rules, void *data) {
+  int oflags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+  if (!(pool->flags & JBOX_WALK_FOLLOW)) oflags |= O_NOFOLLOW;
+  int fd = openat(parent->fd, name, oflags);
+  if (fd < 0) return NULL;
+  return new_node(parent, fd, path, len, depth, rules, data);
+}
+
+
+/**
+ * Finds the type of an entry getdents64 left open.
+ * @param dir_fd Descriptor of its directory
+ * @param name Entry name
+ * @param type d_type from getdents64
+ * @param follow Whether to report a symlink's target
+ * @return DT_* type, or DT_UNKNOWN if it cannot be stat'ed (errno set)
+ */
+static unsigned char resolve_type(int dir_fd, const char *name,
+                                  unsigned char type, bool follow) {
+  if (type != DT_UNKNOWN && !(type == DT_LNK && follow)) return type;
+
+  struct stat st;
+  if (fstatat(dir_fd, name, &st, follow ? 0 : AT_SYMLINK_NOFOLLOW) == 0) {
+    return IFTODT(st.st_mode);
+  }
+  if (type == DT_LNK) return DT_LNK;    /* Dangling */
+  return DT_UNKNOWN;
+}
+
+
+static void queue_or_scan(walk_pool_t *pool, walk_node_t *node);
+
+
+/**
+ * Visits a node's entries, handing each subdirectory to the queue or
+ * reading it inline, then drops the node's reading count.
+ */
+static void scan_node(walk_pool_t *pool, walk_node_t *node) {
+  walk_rules_t *rules = node->rules;
+  node->rules = NULL;
+  char *buf = NULL;
+  char *path = NULL;
+  if (should_stop(pool)) goto out;
+
+  size_t base = node->len;
+  if (base > 0 && node->path[base - 1] != '/') base++;
+  if ((pool->flags & JBOX_WALK_GITIGNORE) && !should_stop(pool)) {
+    size_t rel_len = base - pool->rel_start;
+    walk_rules_t *own = load_gitignore(node->fd, rel_len, rules);
+    if (own) {
+      rules = own;
+    } else if (errno == ENOMEM) {
+      note_out_of_memory(pool);
+      goto out;
+    }
+  }
+
+  size_t cap = base + 256;
+  buf = malloc(JBOX_WALK_DIRENT_BUF_SIZE);
+  path = malloc(cap);
+  if (!buf || !path) {
+    note_out_of_memory(pool);
+    goto out;
+  }
+  memcpy(path, node->path, node->len);
+  path[base - 1] = '/';
+  const bool follow = pool->flags & JBOX_WALK_FOLLOW;
+
+  for (;;) {
+    long got = syscall(SYS_getdents64, node->fd, buf,
+                       JBOX_WALK_DIRENT_BUF_SIZE);
+    if (got < 0 && errno == EINTR) continue;
+    if (got < 0) {
+      report(pool, node->path, errno);
+      break;
+    }
+    if (got == 0) break;
+
+    for (long off = 0; off < got;) {
+      struct walk_dirent64 *d = (struct walk_dirent64 *)(buf + off);
+      off += d->d_reclen;
+      if (should_stop(pool)) goto out;
+
+      const char *name = d->d_name;
+      if (name[0] == '.' &&
+          (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+        continue;
+      }
+      if ((pool->flags & JBOX_WALK_SKIP_GIT) && strcmp(name, ".git") == 0) {
+        continue;
+      }
+
+      size_t name_len = strlen(name);
+      if (base + name_len + 1 > cap) {
+        size_t new_cap = (base + name_len + 1) * 2;
+        char *grown = realloc(path, new_cap);
+        if (!grown) {
+          note_out_of_memory(pool);
+          goto out;
+        }
+        path = grown;
+        cap = new_cap;
+      }
+      memcpy(path + base, name, name_len + 1);
+      const char *rel = path + pool->rel_start;
+
+      unsigned char type = resolve_type(node->fd, name, d->d_type, follow);
+      if (type == DT_UNKNOWN) {
+        if (errno != ENOENT) report(pool, path, errno);
+        continue;
+      }
+      if ((pool->flags & JBOX_WALK_GITIGNORE)
+          && is_ignored(rules, rel, name, type == DT_DIR)) {
+        continue;
+      }
+
+      jbox_walk_entry_t entry = {
+        .path = path,
+        .rel = rel,
+        .name = path + base,
+        .dir_fd = node->fd,
+        .type = type,
+        .depth = node->depth + 1,
+        .parent_data = node->data,
+      };
+      int action = pool->visit(&entry, pool->arg);
+      if (type != DT_DIR || action != JBOX_WALK_CONTINUE ||
+          (pool->max_depth >= 0 && entry.depth >= pool->max_depth)) {
+        leave(pool, entry.data);
+        if (action != JBOX_WALK_STOP) continue;
+        atomic_store(&pool->stopped, true);
+        goto out;
+      }
+
+      walk_node_t *child = open_node(pool, node, name, path,
+                                     base + name_len, entry.depth, rules,
+                                     entry.data);
+      if (!child) {
+        int err = errno;
+        leave(pool, entry.data);
+        if (err == ENOMEM) {
+          note_out_of_memory(pool);
+          goto out;
+        }
+        if (err != ENOENT) report(pool, path, err);
+        continue;
+      }
+      queue_or_scan(pool, child);
+    }
+  }
+
+out:
+  free(path);
+  free(buf);
+  rules_release(rules);
+  close(node->fd);
+  release_node(pool, node);
+}
+
+
+/**
+ * Queues a node for an idle thread, or reads it here when the queue is
+ * long enough already.
+ */
+static void queue_or_scan(walk_pool_t *pool, walk_node_t *node) {
+  pthread_mutex_lock(&pool->lock);
+  int queue_it = pool->queued < JBOX_WALK_QUEUE_LIMIT;
+  if (queue_it) {
+    node->next = pool->queue;
+    pool->queue = node;
+    pool->queued++;
+    pool->outstanding++;
+    pthread_cond_signal(&pool->wake);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  if (!queue_it) scan_node(pool, node);
+}
+
+
+/**
+ * Marks one queued node as finished, ending the walk after the last.
+ */
+static void finish_node(walk_pool_t *pool) {
+  pthread_mutex_lock(&pool->lock);
+  if (--pool->outstanding == 0) {
+    pool->done = 1;
+    pthread_cond_broadcast(&pool->wake);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+
+/**
+ * Worker thread: reads queued directories until none are left.
+ * @param arg The walk_pool_t
+ * @return NULL
+ */
+static void *walk_worker(void *arg) {
+  walk_pool_t *pool = arg;
+  jbox_ctx_adopt(pool->ctx);
+
+  pthread_mutex_lock(&pool->lock);
+  while (!pool->done) {
+    walk_node_t *node = pool->queue;
+    if (!node) {
+      pthread_cond_wait(&pool->wake, &pool->lock);
+      continue;
+    }
+    pool->queue = node->next;
+    pool->queued--;
+    pthread_mutex_unlock(&pool->lock);
+
+    scan_node(pool, node);
+    finish_node(pool);
+
+    pthread_mutex_lock(&pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+
+/**
+ * Visits the root; if it is a directory to descend into, returns it as
+ * the first node.
+ * @return The root node, or NULL when there is nothing to read
+ */
+static walk_node_t *visit_root(walk_pool_t *pool, const char *root) {
+  int fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  int open_errno = errno;
+
+  struct stat st;
+  if (fd < 0 && stat(root, &st) != 0) {
+    report(pool, root, errno);
+    return NULL;
+  }
+
+  jbox_walk_entry_t entry = {
+    .path = root,
+    .rel = "",
+    .name = root,
+    .dir_fd = AT_FDCWD,
+    .type = fd >= 0 ? DT_DIR : IFTODT(st.st_mode),
+    .depth = 0,
+  };
+  int action = pool->visit(&entry, pool->arg);
+
+  if (fd < 0) {
+    if (entry.type == DT_DIR && action == JBOX_WALK_CONTINUE) {
+      report(pool, root, open_errno);
+    }
+    leave(pool, entry.data);
+    return NULL;
+  }
+  if (action != JBOX_WALK_CONTINUE || pool->max_depth == 0) {
+    close(fd);
+    leave(pool, entry.data);
+    return NULL;
+  }
+
+  walk_node_t *node = new_node(NULL, fd, root, strlen(root), 0, NULL,
+                               entry.data);
+  if (!node) {
+    leave(pool, entry.data);
+    note_out_of_memory(pool);
+  }
+  return node;
+}
+
+
+int jbox_walk(const char *root, const jbox_walk_options_t *opts) {
+  size_t root_len = strlen(root);
+  walk_pool_t pool = {
+    .outstanding = 1,
+    .flags = opts->flags,
+    .max_depth = opts->max_depth,
+    .rel_start = root_len + (root_len > 0 && root[root_len - 1] != '/'),
+    .visit = opts->visit,
+    .error = opts->error,
+    .leave = opts->leave,
+    .arg = opts->arg,
+    .ctx = jbox_ctx_current(),
+  };
+  atomic_init(&pool.stopped, false);
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.wake, NULL);
+
+  walk_node_t *top = visit_root(&pool, root);
+  if (top) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = opts->threads > 0 ? opts->threads
+                  : cores > 0 ? (int)cores : 1;
+    if (threads > JBOX_WALK_MAX_WORKERS) threads = JBOX_WALK_MAX_WORKERS;
+
+    pthread_t workers[JBOX_WALK_MAX_WORKERS];
+    int started = 0;
+    for (int i = 0; i < threads - 1; i++) {   /* This thread walks too */
+      if (pthread_create(&workers[i], NULL, walk_worker, &pool) != 0) break;
+      started++;
+    }
+
+    scan_node(&pool, top);
+    finish_node(&pool);
+    walk_worker(&pool);
+
+    for (int i = 0; i < started; i++) {
+      pthread_join(workers[i], NULL);
+    }
+  }
+  pthread_cond_destroy(&pool.wake);
+  pthread_mutex_destroy(&pool.lock);
+
+  if (jbox_is_interrupted()) return -2;
+  if (pool.out_of_memory) {
+    errno = ENOMEM;
+    return -1;
+  }
+  return 0;
+}
+
+
+int jbox_walk_compare_paths(const char *a, const char *b) {
+  const unsigned char *x = (const unsigned char *)a;
+  const unsigned char *y = (const unsigned char *)b;
+  while (*x && *x == *y) {
+    x++;
+    y++;
+  }
+  /* Shift every byte up one so '/' can sit just above the terminator */
+  unsigned cx = *x == '/' ? 1 : *x == '\0' ? 0 : (unsigned)*x + 1;
+  unsigned cy = *y == '/' ? 1 : *y == '\0' ? 0 : (unsigned)*y + 1;
+  return (int)cx - (int)cy;
+}
@@ -0,0 +1,104 @@
+#ifndef JBOX_WALK_H
+#define JBOX_WALK_H
+
+#include <stddef.h>
+
+
+/** Skip entries matched by .gitignore files inside the tree */
+#define JBOX_WALK_GITIGNORE 0x1
+/** Skip anything named .git */
+#define JBOX_WALK_SKIP_GIT  0x2
+/** Follow symlinks: report and descend into what they point to */
+#define JBOX_WALK_FOLLOW    0x4
+
+/** Upper bound on walker threads, the calling thread included */
+#define JBOX_WALK_MAX_WORKERS 16
+
+
+/** What a visitor wants done after seeing an entry */
+enum {
+  JBOX_WALK_CONTINUE = 0,   /**< Go on, descending if it is a directory */
+  JBOX_WALK_SKIP = 1,       /**< Do not descend into this directory */
+  JBOX_WALK_STOP = 2,       /**< End the whole walk */
+};
+
+
+/** One entry of the tree, as handed to the visitor */
+typedef struct {
+  const char *path;         /**< Root joined with rel */
+  const char *rel;          /**< Path below the root; "" for the root */
+  const char *name;         /**< Last component; the root path for the root */
+  int dir_fd;               /**< Containing directory, for the *at() calls;
+                                 AT_FDCWD for the root */
+  unsigned char type;       /**< DT_* type; with JBOX_WALK_FOLLOW, that of
+                                 the symlink's target if it has one */
+  int depth;                /**< 0 for the root */
+  void *parent_data;        /**< Data the visitor gave the containing
+                                 directory; NULL for the root */
+  void *data;               /**< Set by the visitor of a directory to have
+                                 it passed to the entries inside and to
+                                 the leave callback */
+} jbox_walk_entry_t;
+
+/**
+ * Called once per entry, from any of the walker threads at once.
+ * @return JBOX_WALK_CONTINUE, JBOX_WALK_SKIP or JBOX_WALK_STOP
+ */
+typedef int (*jbox_walk_visit_fn)(jbox_walk_entry_t *entry, void *arg);
+
+/** Called with the data of a directory once it and everything below it
+ *  have been visited, or right after its visit if it is not descended
+ *  into. Children are always left before their parent. */
+typedef void (*jbox_walk_leave_fn)(void *data, void *arg);
+
+/** Called for a directory that cannot be opened or read, or an entry
+ *  that cannot be stat'ed; the walk goes on without it. */
+typedef void (*jbox_walk_error_fn)(const char *path, int err, void *arg);
+
+
+typedef struct {
+  int flags;                /**< JBOX_WALK_* flags */
+  int threads;              /**< Threads to walk with; 0 for one per core */
+  int max_depth;            /**< Deepest entries visited; -1 for no limit */
+  jbox_walk_visit_fn visit;
+  jbox_walk_error_fn error; /**< May be NULL */
+  jbox_walk_leave_fn leave; /**< May be NULL; only called for directories
+                                 given data, also when the walk stops */
+  void *arg;                /**< Passed to the callbacks */
+} jbox_walk_options_t;
+
+
+/**
+ * Walk a directory tree, visiting each entry once.
+ *
+ * Directories are read with getdents64 through their own descriptors and
+ * opened with openat() relative to their parent, so no path is resolved
+ * from the root more than once, and d_type saves a stat of every entry
+ * on filesystems that fill it in. Each directory is a unit of work on a
+ * shared queue: any idle thread of the pool takes the next one, so
+ * separate subtrees are read in parallel. Entries therefore arrive in no
+ * particular order, but a directory is always visited before anything
+ * inside it, and left after everything inside it.
+ *
+ * A root that is not a directory is visited alone.
+ *
+ * @param root Path to walk
+ * @param opts Options and callbacks
+ * @return 0 when the walk finished or a visitor stopped it, -1 if out of
+ *         memory (errno set), -2 on interrupt
+ */
+int jbox_walk(const char *root, const jbox_walk_options_t *opts);
+
+/**
+ * Order paths the way a depth-first walk with each directory sorted by
+ * name would produce them: compare byte by byte with '/' below every
+ * other character, so "a/b" comes before "a.txt".
+ *
+ * @param a First path
+ * @param b Second path
+ * @return Negative, zero or positive, as strcmp()
+ */
+int jbox_walk_compare_paths(const char *a, const char *b);
+
+
+#endif /* JBOX_WALK_H */
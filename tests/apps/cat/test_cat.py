@@ -239,6 +239,56 @@ class TestCatCommand(unittest.TestCase):
         finally:
             os.unlink(temp_path)
 
+    def test_json_large_file_spans_chunks(self):
+        """Test JSON output for content larger than one read chunk."""
+        with tempfile.NamedTemporaryFile(mode="w", delete=False) as f:
+            content = 'q"\\\n' * 100000
+            f.write(content)
+            temp_path = f.name
+
+        try:
+            result = self.run_cat("--json", temp_path)
+            self.assertEqual(result.returncode, 0)
+            data = json.loads(result.stdout)
+            self.assertEqual(data[0]["content"], content)
+        finally:
+            os.unlink(temp_path)
+
+    def test_large_file_to_regular_file(self):
+        """Test copying a large file when stdout is a regular file."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            src = Path(tmpdir, "src.bin")
+            dst = Path(tmpdir, "dst.bin")
+            data = os.urandom(300000)
+            src.write_bytes(data)
+
+            with open(dst, "wb") as out:
+                result = subprocess.run(
+                    [str(self.CAT_BIN), str(src), str(src)],
+                    stdout=out,
+                    env={**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
+                )
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(dst.read_bytes(), data + data)
+
+    def test_input_is_output(self):
+        """Test that appending a file to itself is refused."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = Path(tmpdir, "self.txt")
+            path.write_text("data\n")
+
+            with open(path, "ab") as out:
+                result = subprocess.run(
+                    [str(self.CAT_BIN), str(path)],
+                    stdout=out,
+                    stderr=subprocess.PIPE,
+                    text=True,
+                    env={**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
+                )
+            self.assertEqual(result.returncode, 1)
+            self.assertIn("input file is output file", result.stderr)
+            self.assertEqual(path.read_text(), "data\n")
+
     def test_multiline_content(self):
         """Test reading file with multiple lines."""
         with tempfile.NamedTemporaryFile(mode="w", delete=False) as f:
@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+"""Unit tests for the compress command."""
+
+import gzip
+import os
+import shutil
+import struct
+import subprocess
+import tempfile
+import unittest
+from pathlib import Path
+
+
+def text(n):
+    """Compressible input of n bytes."""
+    line = b"".join(b"line %d of the log, level=info\n" % i for i in range(2000))
+    return (line * (n // len(line) + 1))[:n]
+
+
+class TestCompressCommand(unittest.TestCase):
+    """Test cases for the compress command."""
+
+    COMPRESS_BIN = Path(__file__).parent.parent.parent.parent / "bin" / "standalone-apps" / "compress"
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the compress binary exists before running tests."""
+        if not cls.COMPRESS_BIN.exists():
+            raise unittest.SkipTest(f"compress binary not found at {cls.COMPRESS_BIN}")
+
+    def setUp(self):
+        self.tmpdir = tempfile.TemporaryDirectory()
+        self.root = self.tmpdir.name
+
+    def tearDown(self):
+        self.tmpdir.cleanup()
+
+    def run_compress(self, *args, input=None):
+        """Run the compress command with given arguments and return result."""
+        cmd = [str(self.COMPRESS_BIN)] + list(args)
+        result = subprocess.run(
+            cmd,
+            input=input,
+            capture_output=True,
+            cwd=self.root,
+            env={**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
+        )
+        return result
+
+    def roundtrip(self, data, *args):
+        packed = self.run_compress(*args, input=data)
+        self.assertEqual(packed.returncode, 0, packed.stderr)
+        unpacked = self.run_compress("-d", input=packed.stdout)
+        self.assertEqual(unpacked.returncode, 0, unpacked.stderr)
+        self.assertEqual(unpacked.stdout, data)
+        return packed.stdout
+
+    def test_help(self):
+        """Test --help shows usage."""
+        result = self.run_compress("--help")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn(b"Usage: compress", result.stdout)
+
+    def test_gzip_roundtrip(self):
+        """Test gzip output across block boundaries decompresses back."""
+        for n in (0, 1, 1024 * 1024, 3 * 1024 * 1024 + 17):
+            self.roundtrip(os.urandom(n // 2) + text(n - n // 2), "-j", "3")
+
+    def test_zstd_roundtrip(self):
+        """Test zstd output across block boundaries decompresses back."""
+        for n in (0, 1, 4 * 1024 * 1024, 9 * 1024 * 1024 + 5):
+            self.roundtrip(text(n), "-F", "zstd", "-j", "2")
+
+    def test_gzip_readable_by_python(self):
+        """Test the blocks form a standard multi-member gzip file."""
+        data = text(5 * 1024 * 1024)
+        packed = self.roundtrip(data)
+        self.assertEqual(gzip.decompress(packed), data)
+        self.assertLess(len(packed), len(data) // 4)
+
+    def test_gzip_readable_by_gzip(self):
+        """Test gzip -d reads the output."""
+        if not shutil.which("gzip"):
+            self.skipTest("gzip not installed")
+        data = text(2 * 1024 * 1024 + 3)
+        packed = self.roundtrip(data)
+        result = subprocess.run(["gzip", "-dc"], input=packed, capture_output=True)
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, data)
+
+    def test_zstd_readable_by_zstd(self):
+        """Test zstd -d reads the output, skipping the size frames."""
+        if not shutil.which("zstd"):
+            self.skipTest("zstd not installed")
+        data = text(9 * 1024 * 1024)
+        packed = self.roundtrip(data, "-F", "zstd")
+        result = subprocess.run(["zstd", "-dc"], input=packed, capture_output=True)
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, data)
+
+    def test_decompress_foreign_gzip(self):
+        """Test gzip from another tool, several members, decompresses."""
+        data = text(300000)
+        packed = gzip.compress(data[:1000]) + gzip.compress(data[1000:])
+        result = self.run_compress("-d", input=packed)
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, data)
+
+    def test_decompress_mixed_blocks(self):
+        """Test foreign members after our blocks are streamed."""
+        data = text(1500000)
+        ours = self.run_compress(input=data).stdout
+        result = self.run_compress("-d", input=ours + gzip.compress(data))
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, data + data)
+
+    def test_block_header(self):
+        """Test each gzip member records its size in the JB field."""
+        packed = self.run_compress(input=text(2 * 1024 * 1024 + 1)).stdout
+        offset, members = 0, 0
+        while offset < len(packed):
+            self.assertEqual(packed[offset:offset + 4], b"\x1f\x8b\x08\x04")
+            self.assertEqual(packed[offset + 12:offset + 14], b"JB")
+            offset += struct.unpack("<I", packed[offset + 16:offset + 20])[0]
+            members += 1
+        self.assertEqual(offset, len(packed))
+        self.assertEqual(members, 3)
+
+    def test_files(self):
+        """Test FILE and -o instead of the standard streams."""
+        data = text(100000)
+        Path(self.root, "in.txt").write_bytes(data)
+        result = self.run_compress("-F", "zstd", "-o", "out.zst", "in.txt")
+        self.assertEqual(result.returncode, 0)
+        result = self.run_compress("-d", "out.zst")
+        self.assertEqual(result.stdout, data)
+
+    def test_corrupt_input(self):
+        """Test truncated and unknown input fail."""
+        packed = self.run_compress(input=text(100000)).stdout
+        result = self.run_compress("-d", input=packed[:len(packed) // 2])
+        self.assertEqual(result.returncode, 1)
+        result = self.run_compress("-d", input=b"plain text\n")
+        self.assertEqual(result.returncode, 1)
+        self.assertIn(b"not in gzip or zstd format", result.stderr)
+
+    def test_bad_options(self):
+        """Test invalid format, level and input."""
+        for args in (["-F", "xz"], ["-l", "10"], ["-F", "zstd", "-l", "99"],
+                     ["-j", "0"], ["missing.txt"]):
+            result = self.run_compress(*args, input=b"")
+            self.assertEqual(result.returncode, 1, args)
+            self.assertIn(b"compress:", result.stderr)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+"""Unit tests for the count command."""
+
+import json
+import os
+import random
+import subprocess
+import tempfile
+import unittest
+from collections import Counter
+from pathlib import Path
+
+
+class TestCountCommand(unittest.TestCase):
+    """Test cases for the count command."""
+
+    COUNT_BIN = Path(__file__).parent.parent.parent.parent / "bin" / "standalone-apps" / "count"
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the count binary exists before running tests."""
+        if not cls.COUNT_BIN.exists():
+            raise unittest.SkipTest(f"count binary not found at {cls.COUNT_BIN}")
+
+    def setUp(self):
+        self.tmpdir = tempfile.TemporaryDirectory()
+        self.root = self.tmpdir.name
+        Path(self.root, "log").write_text(
+            "10.0.0.1 GET /\n10.0.0.2 GET /a\n10.0.0.1 POST /\n"
+            "10.0.0.3 GET /\n10.0.0.1 GET /a\n")
+
+    def tearDown(self):
+        self.tmpdir.cleanup()
+
+    def run_count(self, *args, input=None):
+        """Run the count command with given arguments and return result."""
+        cmd = [str(self.COUNT_BIN)] + list(args)
+        result = subprocess.run(
+            cmd,
+            input=input,
+            capture_output=True,
+            text=True,
+            cwd=self.root,
+            env={**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
+        )
+        return result
+
+    def test_help(self):
+        """Test --help shows usage."""
+        result = self.run_count("--help")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("Usage: count", result.stdout)
+
+    def test_lines(self):
+        """Test lines are counted, most frequent first, ties by bytes."""
+        result = self.run_count(input="b\na\nb\nc\na\nb\n")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, "      3 b\n      2 a\n      1 c\n")
+
+    def test_field(self):
+        """Test -f counts one blank-separated field."""
+        result = self.run_count("-f", "1", "log")
+        self.assertEqual(result.stdout.split("\n")[0], "      3 10.0.0.1")
+        result = self.run_count("-f", "3", "log", "--json")
+        self.assertEqual(json.loads(result.stdout),
+                         [{"key": "/", "count": 3}, {"key": "/a", "count": 2}])
+
+    def test_separator(self):
+        """Test -t splits fields on a character, keeping blanks."""
+        result = self.run_count("-t", ",", "-f", "2", "--json",
+                                input="x, a\ny, a\nz,a\nw\n")
+        self.assertEqual(json.loads(result.stdout), [
+            {"key": " a", "count": 2}, {"key": "", "count": 1},
+            {"key": "a", "count": 1},
+        ])
+
+    def test_top(self):
+        """Test -n keeps only the most frequent."""
+        result = self.run_count("-n", "1", "-f", "2", "log")
+        self.assertEqual(result.stdout, "      4 GET\n")
+
+    def test_json_empty(self):
+        """Test --json with no input is an empty array."""
+        result = self.run_count("--json", input="")
+        self.assertEqual(json.loads(result.stdout), [])
+
+    def test_unterminated_last_line(self):
+        """Test a last line without a newline is counted."""
+        result = self.run_count("--json", input="a\na")
+        self.assertEqual(json.loads(result.stdout), [{"key": "a", "count": 2}])
+
+    def test_large_file(self):
+        """Test a file of several ranges matches a reference count."""
+        rng = random.Random(3)
+        words = [f"w{rng.randrange(20000)}" for _ in range(2000000)]
+        Path(self.root, "big").write_text("\n".join(words) + "\n")
+        result = self.run_count("--json", "-n", "20", "big")
+        self.assertEqual(result.returncode, 0)
+        expected = sorted(Counter(words).items(),
+                          key=lambda kv: (-kv[1], kv[0]))[:20]
+        self.assertEqual([(d["key"], d["count"]) for d in json.loads(result.stdout)],
+                         expected)
+
+    def test_files_and_stdin(self):
+        """Test counts add up across files and standard input."""
+        result = self.run_count("--json", "log", "-", "log",
+                                input="10.0.0.1 GET /\n")
+        data = json.loads(result.stdout)
+        self.assertEqual(data[0], {"key": "10.0.0.1 GET /", "count": 3})
+
+    def test_missing_file(self):
+        """Test a missing file is reported and the rest still counted."""
+        result = self.run_count("-f", "2", "nosuch", "log")
+        self.assertEqual(result.returncode, 1)
+        self.assertIn("nosuch", result.stderr)
+        self.assertIn("GET", result.stdout)
+
+    def test_invalid_arguments(self):
+        """Test bad fields and top counts are rejected."""
+        self.assertEqual(self.run_count("-f", "0", input="").returncode, 1)
+        self.assertEqual(self.run_count("-n", "0", input="").returncode, 1)
+
+
+if __name__ == "__main__":
+    unittest.main()
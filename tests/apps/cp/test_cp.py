@@ -166,6 +166,47 @@ class TestCpCommand(unittest.TestCase):
                 "nested content"
             )
 
+    def test_copy_large_tree(self):
+        """Test a tree with more files than the copy queue holds."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            src_dir = Path(tmpdir, "srcdir")
+            expected = {}
+            for d in range(8):
+                subdir = src_dir / f"d{d}" / "inner"
+                subdir.mkdir(parents=True)
+                for f in range(60):
+                    data = os.urandom((d * 60 + f) * 37 % 70000)
+                    (subdir / f"f{f}.bin").write_bytes(data)
+                    expected[f"d{d}/inner/f{f}.bin"] = data
+            dest_dir = Path(tmpdir, "destdir")
+
+            result = self.run_cp("-r", str(src_dir), str(dest_dir))
+            self.assertEqual(result.returncode, 0)
+            copied = {
+                str(p.relative_to(dest_dir)): p.read_bytes()
+                for p in dest_dir.rglob("*") if p.is_file()
+            }
+            self.assertEqual(copied, expected)
+
+    def test_recursive_conflict_without_force(self):
+        """Test that a file conflict inside a tree copy is reported."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            src_dir = Path(tmpdir, "srcdir")
+            src_dir.mkdir()
+            (src_dir / "a.txt").write_text("new a")
+            (src_dir / "b.txt").write_text("new b")
+            dest_dir = Path(tmpdir, "destdir")
+            dest_dir.mkdir()
+            (dest_dir / "srcdir").mkdir()
+            (dest_dir / "srcdir" / "a.txt").write_text("old a")
+
+            result = self.run_cp("-r", str(src_dir), str(dest_dir))
+            self.assertNotEqual(result.returncode, 0)
+            self.assertEqual((dest_dir / "srcdir" / "a.txt").read_text(),
+                             "old a")
+            self.assertEqual((dest_dir / "srcdir" / "b.txt").read_text(),
+                             "new b")
+
     def test_overwrite_without_force(self):
         """Test error when overwriting without -f flag."""
         with tempfile.TemporaryDirectory() as tmpdir:
@@ -260,6 +301,24 @@ class TestCpCommand(unittest.TestCase):
             self.assertEqual(result.returncode, 0)
             self.assertEqual(dest.read_text(), content)
 
+    def test_copy_sparse_file(self):
+        """Test that holes in a sparse file are not filled in."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            src = Path(tmpdir, "sparse.img")
+            dest = Path(tmpdir, "copy.img")
+            with open(src, "wb") as f:
+                f.write(b"start")
+                f.seek(32 << 20)
+                f.write(b"middle")
+                f.truncate(64 << 20)
+            if os.stat(src).st_blocks * 512 >= os.stat(src).st_size:
+                self.skipTest("Filesystem doesn't support sparse files")
+
+            result = self.run_cp(str(src), str(dest))
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(dest.read_bytes(), src.read_bytes())
+            self.assertLess(os.stat(dest).st_blocks * 512, 1 << 20)
+
     def test_copy_empty_directory(self):
         """Test copying an empty directory."""
         with tempfile.TemporaryDirectory() as tmpdir:
@@ -303,6 +362,64 @@ class TestCpCommand(unittest.TestCase):
             dest_mode = os.stat(dest).st_mode & 0o777
             self.assertEqual(src_mode, dest_mode)
 
+    def test_update_skips_unchanged(self):
+        """Test -u copies changed files and leaves unchanged ones alone."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            src = Path(tmpdir, "src")
+            (src / "sub").mkdir(parents=True)
+            (src / "a.txt").write_text("one")
+            (src / "sub" / "b.txt").write_text("two")
+            dest = Path(tmpdir, "dest")
+
+            result = self.run_cp("-r", "-u", "--json", str(src), str(dest))
+            self.assertEqual(json.loads(result.stdout)["copied"], 2)
+            self.assertEqual(os.stat(dest / "a.txt").st_mtime_ns,
+                             os.stat(src / "a.txt").st_mtime_ns)
+
+            (src / "a.txt").write_text("ONE")
+            result = self.run_cp("-r", "-u", "--json", str(src) + "/.",
+                                 str(dest))
+            self.assertEqual(result.returncode, 0)
+            output = json.loads(result.stdout)
+            self.assertEqual((output["copied"], output["skipped"]), (1, 1))
+            self.assertEqual((dest / "a.txt").read_text(), "ONE")
+
+    def test_sync_mirrors_tree(self):
+        """Test --sync makes DEST a mirror of SOURCE, deleting extras."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            src = Path(tmpdir, "src")
+            (src / "keep").mkdir(parents=True)
+            (src / "keep" / "f").write_text("data")
+            (src / "file").write_text("x")
+            dest = Path(tmpdir, "dest")
+
+            result = self.run_cp("--sync", str(src), str(dest))
+            self.assertEqual(result.returncode, 0)
+            (dest / "stray").write_text("old")
+            (dest / "gone").mkdir()
+            (dest / "gone" / "g").write_text("old")
+            (dest / "keep" / "extra").write_text("old")
+            (src / "file").unlink()
+            (src / "file").mkdir()
+
+            result = self.run_cp("--sync", "--json", str(src), str(dest))
+            self.assertEqual(result.returncode, 0)
+            output = json.loads(result.stdout)
+            self.assertEqual((output["copied"], output["skipped"],
+                              output["deleted"]), (0, 1, 4))
+            self.assertEqual(sorted(str(p.relative_to(dest))
+                                    for p in dest.rglob("*")),
+                             ["file", "keep", "keep/f"])
+            self.assertTrue((dest / "file").is_dir())
+
+    def test_delete_needs_recursive(self):
+        """Test --delete is refused without -r."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            src = Path(tmpdir, "a.txt")
+            src.write_text("x")
+            result = self.run_cp("--delete", str(src), str(Path(tmpdir, "b")))
+            self.assertEqual(result.returncode, 1)
+
 
 if __name__ == "__main__":
     unittest.main()
@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+"""Unit tests for the cut command."""
+
+import csv
+import io
+import json
+import os
+import random
+import subprocess
+import tempfile
+import unittest
+from pathlib import Path
+
+
+class TestCutCommand(unittest.TestCase):
+    """Test cases for the cut command."""
+
+    CUT_BIN = Path(__file__).parent.parent.parent.parent / "bin" / "standalone-apps" / "cut"
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the cut binary exists before running tests."""
+        if not cls.CUT_BIN.exists():
+            raise unittest.SkipTest(f"cut binary not found at {cls.CUT_BIN}")
+
+    def setUp(self):
+        self.tmpdir = tempfile.TemporaryDirectory()
+        self.root = self.tmpdir.name
+        Path(self.root, "data.tsv").write_text(
+            "a\tb\tc\td\n1\t2\t3\t4\nno tabs here\nx\ty\n")
+
+    def tearDown(self):
+        self.tmpdir.cleanup()
+
+    def run_cut(self, *args, input=None):
+        """Run the cut command with given arguments and return result."""
+        cmd = [str(self.CUT_BIN)] + list(args)
+        result = subprocess.run(
+            cmd,
+            input=input,
+            capture_output=True,
+            text=True,
+            cwd=self.root,
+            env={**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
+        )
+        return result
+
+    def test_help(self):
+        """Test --help shows usage."""
+        result = self.run_cut("--help")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("Usage: cut", result.stdout)
+
+    def test_fields(self):
+        """Test single fields, ranges and lines without a delimiter."""
+        result = self.run_cut("-f", "2", "data.tsv")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, "b\n2\nno tabs here\ny\n")
+        result = self.run_cut("-f", "3-", "data.tsv")
+        self.assertEqual(result.stdout, "c\td\n3\t4\nno tabs here\n\n")
+
+    def test_list_order(self):
+        """Test fields print in input order and once each."""
+        result = self.run_cut("-f", "4,1,1-2,-1", "data.tsv")
+        self.assertEqual(result.stdout.split("\n")[:2], ["a\tb\td", "1\t2\t4"])
+
+    def test_only_delimited(self):
+        """Test -s drops lines without a delimiter."""
+        result = self.run_cut("-s", "-f", "1", "data.tsv")
+        self.assertEqual(result.stdout, "a\n1\nx\n")
+
+    def test_delimiters(self):
+        """Test -d and --output-delimiter."""
+        result = self.run_cut("-d", ":", "-f", "1,3", "--output-delimiter",
+                              " | ", input="root:x:0:0\nnobody:x:65534\n")
+        self.assertEqual(result.stdout, "root | 0\nnobody | 65534\n")
+
+    def test_unterminated_last_line(self):
+        """Test a last line without a newline is cut."""
+        result = self.run_cut("-d", ",", "-f", "2", input="a,b\nc,d")
+        self.assertEqual(result.stdout, "b\nd\n")
+
+    def test_csv_quotes(self):
+        """Test quoted CSV fields keep delimiters, quotes and newlines."""
+        data = 'id,text,n\r\n1,"a, b",2\r\n2,"say ""hi""\nthere",3\r\n'
+        result = self.run_cut("--csv", "-f", "2-", "--json-stream",
+                              input=data)
+        self.assertEqual([json.loads(l) for l in result.stdout.splitlines()], [
+            ["text", "n"], ["a, b", "2"], ['say "hi"\nthere', "3"],
+        ])
+        result = self.run_cut("--csv", "-f", "2", input=data)
+        self.assertEqual(result.stdout,
+                         'text\n"a, b"\n"say ""hi""\nthere"\n')
+
+    def test_json_stream(self):
+        """Test --json-stream prints one array per line."""
+        result = self.run_cut("-f", "2,9", "--json-stream", "data.tsv")
+        self.assertEqual([json.loads(l) for l in result.stdout.splitlines()],
+                         [["b"], ["2"], ["no tabs here"], ["y"]])
+
+    def test_large_csv(self):
+        """Test records crossing read buffers match a reference parser."""
+        rng = random.Random(5)
+        rows = [[rng.choice(["", "plain", "with,comma", 'q"t', "two\nlines"])
+                 * rng.randrange(1, 300) for _ in range(4)]
+                for _ in range(3000)]
+        buf = io.StringIO()
+        csv.writer(buf, lineterminator="\n").writerows(rows)
+        Path(self.root, "big.csv").write_text(buf.getvalue())
+        result = self.run_cut("--csv", "-f", "1,3", "--json-stream",
+                              "big.csv")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual([json.loads(l) for l in result.stdout.splitlines()],
+                         [[r[0], r[2]] for r in rows])
+
+    def test_files_and_stdin(self):
+        """Test several inputs are cut in order."""
+        result = self.run_cut("-f", "1", "-s", "data.tsv", "-",
+                              input="s\tt\n")
+        self.assertEqual(result.stdout, "a\n1\nx\ns\n")
+
+    def test_missing_file(self):
+        """Test a missing file is reported and the rest still cut."""
+        result = self.run_cut("-f", "1", "-s", "nosuch", "data.tsv")
+        self.assertEqual(result.returncode, 1)
+        self.assertIn("nosuch", result.stderr)
+        self.assertEqual(result.stdout, "a\n1\nx\n")
+
+    def test_invalid_arguments(self):
+        """Test bad field lists and delimiters are rejected."""
+        for args in (["-f", "0"], ["-f", "3-1"], ["-f", "x"], [],
+                     ["-f", "1", "-d", "ab"]):
+            result = self.run_cut(*args, input="")
+            self.assertEqual(result.returncode, 1, args)
+            self.assertIn("Try 'cut --help'", result.stderr)
+
+
+if __name__ == "__main__":
+    unittest.main()
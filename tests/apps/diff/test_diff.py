@@ -0,0 +1,180 @@
+#!/usr/bin/env python3
+"""Unit tests for the diff command."""
+
+import json
+import os
+import random
+import shutil
+import subprocess
+import tempfile
+import unittest
+from pathlib import Path
+
+
+class TestDiffCommand(unittest.TestCase):
+    """Test cases for the diff command."""
+
+    DIFF_BIN = Path(__file__).parent.parent.parent.parent / "bin" / "standalone-apps" / "diff"
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the diff binary exists before running tests."""
+        if not cls.DIFF_BIN.exists():
+            raise unittest.SkipTest(f"diff binary not found at {cls.DIFF_BIN}")
+
+    def setUp(self):
+        self.tmpdir = tempfile.TemporaryDirectory()
+        self.root = self.tmpdir.name
+        Path(self.root, "old.txt").write_text("a\nb\nc\nd\ne\nf\ng\nh\n")
+        Path(self.root, "new.txt").write_text("a\nB\nc\nd\ne\nf\ng\nh\ni\n")
+
+    def tearDown(self):
+        self.tmpdir.cleanup()
+
+    def run_diff(self, *args, input=None):
+        """Run the diff command with given arguments and return result."""
+        cmd = [str(self.DIFF_BIN)] + list(args)
+        result = subprocess.run(
+            cmd,
+            input=input,
+            capture_output=True,
+            text=True,
+            cwd=self.root,
+            env={**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
+        )
+        return result
+
+    def patch_applies(self, old, new, patch):
+        """Check that patch turns old into new, if patch(1) is available."""
+        if not shutil.which("patch"):
+            return
+        Path(self.root, "work").write_text(old)
+        Path(self.root, "p.diff").write_text(patch)
+        subprocess.run(["patch", "-s", "work", "p.diff"], cwd=self.root,
+                       check=True, capture_output=True)
+        self.assertEqual(Path(self.root, "work").read_text(), new)
+
+    def test_help(self):
+        """Test --help shows usage."""
+        result = self.run_diff("--help")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("Usage: diff", result.stdout)
+
+    def test_identical(self):
+        """Test identical files print nothing and exit 0."""
+        result = self.run_diff("old.txt", "old.txt")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, "")
+
+    def test_normal(self):
+        """Test the default normal format."""
+        result = self.run_diff("old.txt", "new.txt")
+        self.assertEqual(result.returncode, 1)
+        self.assertEqual(result.stdout,
+                         "2c2\n< b\n---\n> B\n8a9\n> i\n")
+
+    def test_normal_delete(self):
+        """Test deletions in normal format."""
+        Path(self.root, "short.txt").write_text("a\nd\ne\nf\ng\nh\n")
+        result = self.run_diff("old.txt", "short.txt")
+        self.assertEqual(result.returncode, 1)
+        self.assertEqual(result.stdout, "2,3d1\n< b\n< c\n")
+
+    def test_unified(self):
+        """Test unified hunks, merged when their context overlaps."""
+        result = self.run_diff("-U", "2", "old.txt", "new.txt")
+        self.assertEqual(result.returncode, 1)
+        lines = result.stdout.splitlines()
+        self.assertTrue(lines[0].startswith("--- old.txt\t"))
+        self.assertTrue(lines[1].startswith("+++ new.txt\t"))
+        self.assertEqual(lines[2:], [
+            "@@ -1,4 +1,4 @@", " a", "-b", "+B", " c", " d",
+            "@@ -7,2 +7,3 @@", " g", " h", "+i"])
+        result = self.run_diff("-u", "old.txt", "new.txt")
+        self.assertEqual(result.stdout.splitlines()[2],
+                         "@@ -1,8 +1,9 @@")
+
+    def test_unified_zero_context(self):
+        """Test -U 0 numbers empty ranges by the line before."""
+        result = self.run_diff("-U", "0", "old.txt", "new.txt")
+        self.assertEqual(result.stdout.splitlines()[2:],
+                         ["@@ -2 +2 @@", "-b", "+B", "@@ -8,0 +9 @@", "+i"])
+
+    def test_no_newline_at_end(self):
+        """Test a missing final newline is marked and compared."""
+        Path(self.root, "x").write_text("a\nb")
+        Path(self.root, "y").write_text("a\nb\n")
+        result = self.run_diff("x", "y")
+        self.assertEqual(result.returncode, 1)
+        self.assertEqual(result.stdout,
+                         "2c2\n< b\n\\ No newline at end of file\n"
+                         "---\n> b\n")
+
+    def test_json(self):
+        """Test --json hunks."""
+        result = self.run_diff("--json", "-U", "1", "old.txt", "new.txt")
+        self.assertEqual(result.returncode, 1)
+        data = json.loads(result.stdout)
+        self.assertEqual(data["old"], "old.txt")
+        self.assertEqual(data["new"], "new.txt")
+        self.assertEqual(data["hunks"], [
+            {"old_start": 1, "old_lines": 3, "new_start": 1, "new_lines": 3,
+             "lines": [" a", "-b", "+B", " c"]},
+            {"old_start": 8, "old_lines": 1, "new_start": 8, "new_lines": 2,
+             "lines": [" h", "+i"]},
+        ])
+        result = self.run_diff("--json", "old.txt", "old.txt")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(json.loads(result.stdout)["hunks"], [])
+
+    def test_brief_and_binary(self):
+        """Test -q and binary files."""
+        result = self.run_diff("-q", "old.txt", "new.txt")
+        self.assertEqual(result.returncode, 1)
+        self.assertEqual(result.stdout, "Files old.txt and new.txt differ\n")
+        Path(self.root, "bin").write_bytes(b"a\0b\n")
+        result = self.run_diff("bin", "old.txt")
+        self.assertEqual(result.returncode, 1)
+        self.assertEqual(result.stdout, "Binary files bin and old.txt differ\n")
+
+    def test_stdin(self):
+        """Test - reads standard input."""
+        result = self.run_diff("-", "new.txt",
+                               input=Path(self.root, "old.txt").read_text())
+        self.assertEqual(result.returncode, 1)
+        self.assertEqual(result.stdout, "2c2\n< b\n---\n> B\n8a9\n> i\n")
+
+    def test_missing_file(self):
+        """Test a missing file is trouble (exit 2)."""
+        result = self.run_diff("old.txt", "missing.txt")
+        self.assertEqual(result.returncode, 2)
+        self.assertIn("missing.txt", result.stderr)
+
+    def test_random_edits_apply(self):
+        """Test diffs of random edits are minimal and apply with patch."""
+        rng = random.Random(7)
+        for _ in range(30):
+            old = [str(rng.randint(0, 9)) for _ in range(rng.randint(0, 60))]
+            new = list(old)
+            edits = 0
+            for _ in range(rng.randint(1, 6)):
+                if new and rng.random() < 0.5:
+                    del new[rng.randrange(len(new))]
+                else:
+                    new.insert(rng.randint(0, len(new)), "x")
+                edits += 1
+            old_text = "".join(line + "\n" for line in old)
+            new_text = "".join(line + "\n" for line in new)
+            Path(self.root, "o").write_text(old_text)
+            Path(self.root, "n").write_text(new_text)
+            result = self.run_diff("-u", "o", "n")
+            self.assertEqual(result.returncode, 0 if old == new else 1)
+            changed = [line for line in result.stdout.splitlines()[2:]
+                       if line[:1] in "+-"]
+            self.assertLessEqual(len(changed), edits)
+            if old != new:
+                self.patch_applies(old_text, new_text, result.stdout)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,152 @@
+#!/usr/bin/env python3
+"""Unit tests for the du command."""
+
+import json
+import os
+import subprocess
+import tempfile
+import unittest
+from pathlib import Path
+
+
+class TestDuCommand(unittest.TestCase):
+    """Test cases for the du command."""
+
+    DU_BIN = Path(__file__).parent.parent.parent.parent / "bin" / "standalone-apps" / "du"
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the du binary exists before running tests."""
+        if not cls.DU_BIN.exists():
+            raise unittest.SkipTest(f"du binary not found at {cls.DU_BIN}")
+
+    def setUp(self):
+        """Create a small tree to measure."""
+        self.tmpdir = tempfile.TemporaryDirectory()
+        self.root = self.tmpdir.name
+        os.makedirs(os.path.join(self.root, "t", "a", "b"))
+        os.makedirs(os.path.join(self.root, "t", "c"))
+        Path(self.root, "t", "a", "x").write_text("hello\n")
+        Path(self.root, "t", "a", "b", "y").write_bytes(b"\1" * 5000)
+        os.link(os.path.join(self.root, "t", "a", "b", "y"),
+                os.path.join(self.root, "t", "c", "y2"))
+        os.symlink("a", os.path.join(self.root, "t", "l"))
+
+    def tearDown(self):
+        self.tmpdir.cleanup()
+
+    def run_du(self, *args):
+        """Run the du command with given arguments and return result."""
+        cmd = [str(self.DU_BIN)] + list(args)
+        result = subprocess.run(
+            cmd,
+            capture_output=True,
+            text=True,
+            cwd=self.root,
+            env={**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
+        )
+        return result
+
+    def totals(self, result):
+        """Map each printed path to its total."""
+        return {path: int(size) for size, path in
+                (line.split("\t") for line in result.stdout.splitlines())}
+
+    def dir_size(self, path):
+        """Apparent size of a directory itself."""
+        return os.lstat(os.path.join(self.root, path)).st_size
+
+    def test_help(self):
+        """Test --help shows usage."""
+        result = self.run_du("--help")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("Usage: du", result.stdout)
+        self.assertIn("--max-depth", result.stdout)
+
+    def test_order(self):
+        """Test totals are printed depth-first, directories last."""
+        result = self.run_du("t")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual([line.split("\t")[1]
+                          for line in result.stdout.splitlines()],
+                         ["t/a/b", "t/a", "t/c", "t"])
+
+    def test_apparent_bytes(self):
+        """Test --apparent-size -b sums sizes, counting hard links once."""
+        totals = self.totals(self.run_du("-b", "--apparent-size", "t"))
+        link = len(os.readlink(os.path.join(self.root, "t", "l")))
+        dirs = sum(self.dir_size(d) for d in ("t", "t/a", "t/a/b", "t/c"))
+        self.assertEqual(totals["t"], dirs + 6 + 5000 + link)
+
+    def test_hard_links_counted_once(self):
+        """Test the two links of one file add up to one copy."""
+        totals = self.totals(self.run_du("-b", "--apparent-size", "t"))
+        once = totals["t/a/b"] - self.dir_size("t/a/b")
+        once += totals["t/c"] - self.dir_size("t/c")
+        self.assertEqual(once, 5000)
+
+    def test_kib_rounds_up(self):
+        """Test the default unit is KiB of allocated blocks."""
+        blocks = self.totals(self.run_du("t"))
+        exact = self.totals(self.run_du("-b", "t"))
+        for path, size in exact.items():
+            self.assertEqual(blocks[path], (size + 1023) // 1024)
+
+    def test_summarize(self):
+        """Test -s prints one total per PATH."""
+        result = self.run_du("-s", "t", "t/a")
+        self.assertEqual([line.split("\t")[1]
+                          for line in result.stdout.splitlines()],
+                         ["t", "t/a"])
+
+    def test_max_depth(self):
+        """Test --max-depth limits what is printed but not what is counted."""
+        shallow = self.totals(self.run_du("-d", "1", "t"))
+        self.assertEqual(sorted(shallow), ["t", "t/a", "t/c"])
+        self.assertEqual(shallow["t"], self.totals(self.run_du("t"))["t"])
+
+    def test_file_argument(self):
+        """Test a file PATH prints its own usage."""
+        result = self.run_du("-b", "--apparent-size", "t/a/x")
+        self.assertEqual(result.stdout, "6\tt/a/x\n")
+
+    def test_json(self):
+        """Test --json prints an array of totals."""
+        result = self.run_du("--json", "t")
+        self.assertEqual(result.returncode, 0)
+        data = json.loads(result.stdout)
+        self.assertEqual([d["path"] for d in data], ["t/a/b", "t/a", "t/c", "t"])
+        self.assertEqual(data[-1]["files"], 4)
+        self.assertEqual(data[-1]["bytes"], self.totals(self.run_du("-b", "t"))["t"])
+
+    def test_json_stream(self):
+        """Test --json-stream prints one object per directory."""
+        result = self.run_du("--json-stream", "t")
+        objs = [json.loads(line) for line in result.stdout.splitlines()]
+        self.assertEqual(sorted(o["path"] for o in objs),
+                         ["t", "t/a", "t/a/b", "t/c"])
+        self.assertEqual(objs[-1]["path"], "t")
+
+    def test_missing_path(self):
+        """Test a missing path is reported and the rest still measured."""
+        result = self.run_du("nosuch", "t/c")
+        self.assertEqual(result.returncode, 1)
+        self.assertIn("nosuch", result.stderr)
+        self.assertEqual(list(self.totals(result)), ["t/c"])
+
+    def test_many_directories(self):
+        """Test a wide tree walked in parallel adds up."""
+        for i in range(40):
+            d = Path(self.root, "wide", f"d{i:02d}")
+            d.mkdir(parents=True)
+            for j in range(10):
+                Path(d, f"f{j}").write_bytes(b"x" * 100)
+        totals = self.totals(self.run_du("-b", "--apparent-size", "wide"))
+        self.assertEqual(len(totals), 41)
+        expected = self.dir_size("wide") + sum(
+            self.dir_size(f"wide/d{i:02d}") + 1000 for i in range(40))
+        self.assertEqual(totals["wide"], expected)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,173 @@
+#!/usr/bin/env python3
+"""Unit tests for the find command."""
+
+import json
+import os
+import subprocess
+import tempfile
+import time
+import unittest
+from pathlib import Path
+
+
+class TestFindCommand(unittest.TestCase):
+    """Test cases for the find command."""
+
+    FIND_BIN = Path(__file__).parent.parent.parent.parent / "bin" / "standalone-apps" / "find"
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the find binary exists before running tests."""
+        if not cls.FIND_BIN.exists():
+            raise unittest.SkipTest(f"find binary not found at {cls.FIND_BIN}")
+
+    def setUp(self):
+        """Create a small tree to search."""
+        self.tmpdir = tempfile.TemporaryDirectory()
+        self.root = self.tmpdir.name
+        os.makedirs(os.path.join(self.root, "src", "sub"))
+        Path(self.root, "README.md").write_text("")
+        Path(self.root, "src", "a.c").write_text("hello\n")
+        Path(self.root, "src", "big.bin").write_bytes(b"\0" * 3000)
+        Path(self.root, "src", "sub", "B.C").write_text("")
+        os.symlink("src", os.path.join(self.root, "link"))
+
+    def tearDown(self):
+        self.tmpdir.cleanup()
+
+    def run_find(self, *args):
+        """Run the find command with given arguments and return result."""
+        cmd = [str(self.FIND_BIN)] + list(args)
+        result = subprocess.run(
+            cmd,
+            capture_output=True,
+            text=True,
+            cwd=self.root,
+            env={**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
+        )
+        return result
+
+    def lines(self, result):
+        """Split output into lines."""
+        return result.stdout.splitlines()
+
+    def test_help(self):
+        """Test --help shows usage."""
+        result = self.run_find("--help")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("Usage: find", result.stdout)
+        self.assertIn("--name", result.stdout)
+
+    def test_lists_everything_sorted(self):
+        """Test every entry is printed, depth-first by name."""
+        result = self.run_find(".")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(self.lines(result), [
+            ".", "./README.md", "./link", "./src", "./src/a.c",
+            "./src/big.bin", "./src/sub", "./src/sub/B.C",
+        ])
+
+    def test_default_path(self):
+        """Test the current directory is searched by default."""
+        self.assertEqual(self.run_find().stdout, self.run_find(".").stdout)
+
+    def test_name(self):
+        """Test --name matches the base name with a shell pattern."""
+        result = self.run_find(".", "--name", "*.c")
+        self.assertEqual(self.lines(result), ["./src/a.c"])
+
+    def test_iname(self):
+        """Test --iname ignores case."""
+        result = self.run_find(".", "--iname", "*.c")
+        self.assertEqual(self.lines(result), ["./src/a.c", "./src/sub/B.C"])
+
+    def test_type(self):
+        """Test --type selects directories, files and symlinks."""
+        self.assertEqual(self.lines(self.run_find(".", "--type", "d")),
+                         [".", "./src", "./src/sub"])
+        self.assertEqual(self.lines(self.run_find(".", "--type", "l")),
+                         ["./link"])
+        self.assertEqual(len(self.lines(self.run_find(".", "--type", "f"))),
+                         4)
+
+    def test_symlinks_not_followed(self):
+        """Test the tree behind a symlink is not walked."""
+        result = self.run_find(".")
+        self.assertFalse(any(line.startswith("./link/")
+                             for line in self.lines(result)))
+
+    def test_size(self):
+        """Test --size with units and comparisons."""
+        result = self.run_find(".", "--type", "f", "--size", "+2k")
+        self.assertEqual(self.lines(result), ["./src/big.bin"])
+        result = self.run_find(".", "--type", "f", "--size", "6c")
+        self.assertEqual(self.lines(result), ["./src/a.c"])
+        result = self.run_find(".", "--type", "f", "--size", "-1k")
+        self.assertEqual(self.lines(result), ["./README.md", "./src/sub/B.C"])
+
+    def test_mtime(self):
+        """Test --mtime counts whole days."""
+        old = time.time() - 10 * 86400
+        os.utime(os.path.join(self.root, "src", "a.c"), (old, old))
+        result = self.run_find(".", "--mtime", "+5")
+        self.assertEqual(self.lines(result), ["./src/a.c"])
+        result = self.run_find(".", "--type", "f", "--mtime", "-1")
+        self.assertNotIn("./src/a.c", self.lines(result))
+        self.assertIn("./README.md", self.lines(result))
+
+    def test_depth(self):
+        """Test --maxdepth and --mindepth."""
+        result = self.run_find(".", "--maxdepth", "1")
+        self.assertEqual(self.lines(result),
+                         [".", "./README.md", "./link", "./src"])
+        result = self.run_find(".", "--mindepth", "2", "--maxdepth", "2")
+        self.assertEqual(self.lines(result),
+                         ["./src/a.c", "./src/big.bin", "./src/sub"])
+
+    def test_print0(self):
+        """Test --print0 ends paths with NUL."""
+        result = self.run_find(".", "--print0", "--name", "*.c")
+        self.assertEqual(result.stdout, "./src/a.c\0")
+
+    def test_json(self):
+        """Test --json prints an array of entries."""
+        result = self.run_find(".", "--json", "--name", "a.c")
+        self.assertEqual(result.returncode, 0)
+        data = json.loads(result.stdout)
+        self.assertEqual(len(data), 1)
+        self.assertEqual(data[0]["path"], "./src/a.c")
+        self.assertEqual(data[0]["type"], "file")
+        self.assertEqual(data[0]["size"], 6)
+        self.assertIn("mtime", data[0])
+
+    def test_json_no_matches(self):
+        """Test --json with no matches is an empty array."""
+        result = self.run_find(".", "--json", "--name", "nothing")
+        self.assertEqual(json.loads(result.stdout), [])
+
+    def test_missing_path(self):
+        """Test a missing path is reported and the rest still searched."""
+        result = self.run_find("nosuch", "src/sub")
+        self.assertEqual(result.returncode, 1)
+        self.assertIn("nosuch", result.stderr)
+        self.assertEqual(self.lines(result), ["src/sub", "src/sub/B.C"])
+
+    def test_invalid_arguments(self):
+        """Test bad --type and --size values are rejected."""
+        self.assertEqual(self.run_find(".", "--type", "x").returncode, 1)
+        self.assertEqual(self.run_find(".", "--size", "3q").returncode, 1)
+
+    def test_many_directories(self):
+        """Test a wide tree walked in parallel is listed completely."""
+        for i in range(40):
+            d = Path(self.root, "wide", f"d{i:02d}")
+            d.mkdir(parents=True)
+            for j in range(10):
+                Path(d, f"f{j}").write_text("x")
+        result = self.run_find("wide", "--type", "f")
+        expected = [f"wide/d{i:02d}/f{j}" for i in range(40) for j in range(10)]
+        self.assertEqual(self.lines(result), expected)
+
+
+if __name__ == "__main__":
+    unittest.main()
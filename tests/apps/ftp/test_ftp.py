@@ -75,7 +75,8 @@ class FtpClientTestCase(unittest.TestCase):
         if cls.test_local:
             shutil.rmtree(cls.test_local, ignore_errors=True)
 
-    def run_ftp(self, *args, input_data=None, timeout=10):
+    def run_ftp(self, *args, input_data=None, timeout=10, cwd=None,
+                env=None):
         """Run the FTP client with given arguments."""
         cmd = [str(self.FTP_BIN)] + list(args)
         result = subprocess.run(
@@ -84,7 +85,9 @@ class FtpClientTestCase(unittest.TestCase):
             capture_output=True,
             text=True,
             timeout=timeout,
-            env={**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
+            cwd=cwd,
+            env={**os.environ, "ASAN_OPTIONS": "detect_leaks=0",
+                 **(env or {})}
         )
         return result
 
@@ -181,6 +184,46 @@ class FtpClientTestCase(unittest.TestCase):
         self.assertEqual(result.returncode, 0)
         self.assertIn("nested.txt", result.stdout)
 
+    def test_ls_large_directory(self):
+        """Test ls streams a listing of thousands of entries."""
+        big = Path(self.test_root) / "listing"
+        big.mkdir()
+        names = {f"file_{i:05d}" for i in range(3000)}
+        for name in names:
+            (big / name).touch()
+        try:
+            result = self.run_ftp_interactive(["ls listing"], json_output=True)
+            self.assertEqual(result.returncode, 0)
+            line = next(l for l in result.stdout.splitlines()
+                        if '"action":"ls"' in l)
+            data = json.loads(line)
+            self.assertEqual(data["status"], "ok")
+            listed = {l.split()[-1] for l in data["listing"].splitlines()}
+            self.assertEqual(listed, names)
+        finally:
+            shutil.rmtree(big)
+
+    def test_mls_command(self):
+        """Test mls lists entries with their facts."""
+        result = self.run_ftp_interactive(["mls"])
+        self.assertEqual(result.returncode, 0)
+        self.assertRegex(result.stdout,
+                         r"file +15 \d{4}-\d\d-\d\d \d\d:\d\d serverfile.txt")
+        self.assertRegex(result.stdout, r"dir +\d+ .* subdir\n")
+
+    def test_mls_json(self):
+        """Test mls with JSON output."""
+        result = self.run_ftp_interactive(["mls subdir", "mls nosuchdir"],
+                                          json_output=True)
+        self.assertEqual(result.returncode, 0)
+        replies = [json.loads(l) for l in result.stdout.splitlines()
+                   if '"action":"mls"' in l]
+        self.assertEqual(replies[0]["status"], "ok")
+        self.assertEqual(replies[0]["entries"][0]["name"], "nested.txt")
+        self.assertEqual(replies[0]["entries"][0]["type"], "file")
+        self.assertEqual(replies[0]["entries"][0]["size"], 7)
+        self.assertEqual(replies[1]["status"], "error")
+
     def test_cd_command(self):
         """Test cd command changes directory."""
         result = self.run_ftp_interactive(["cd subdir", "pwd"], json_output=False)
@@ -230,6 +273,16 @@ class FtpClientTestCase(unittest.TestCase):
         self.assertTrue(local_file.exists())
         self.assertEqual(local_file.read_text(), "Server content\n")
 
+    def test_get_active_mode(self):
+        """Test get command over an active (PORT) data connection."""
+        local_file = Path(self.test_local) / "downloaded_active.txt"
+        result = self.run_ftp(
+            "-H", "localhost", "-p", str(self.SERVER_PORT), "--active",
+            input_data=f"get serverfile.txt {local_file}\nls\nquit\n")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(local_file.read_text(), "Server content\n")
+        self.assertIn("subdir", result.stdout)
+
     def test_get_json(self):
         """Test get command with JSON output."""
         local_file = Path(self.test_local) / "downloaded_json.txt"
@@ -247,6 +300,16 @@ class FtpClientTestCase(unittest.TestCase):
         self.assertEqual(result.returncode, 0)
         self.assertIn("missing", result.stderr.lower())
 
+    def test_get_resume(self):
+        """Test get --resume fetches only the rest of a partial file."""
+        local_file = Path(self.test_local) / "partial_get.txt"
+        local_file.write_text("Server ")
+        result = self.run_ftp_interactive(
+            [f"get --resume serverfile.txt {local_file}"])
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("Downloaded", result.stdout)
+        self.assertEqual(local_file.read_text(), "Server content\n")
+
     def test_put_command(self):
         """Test put command uploads file."""
         # Create local file to upload
@@ -275,14 +338,326 @@ class FtpClientTestCase(unittest.TestCase):
         self.assertIn('"action":"put"', result.stdout)
         self.assertIn('"status":"ok"', result.stdout)
 
+    def test_put_append(self):
+        """Test put --append sends only what the server lacks."""
+        local_file = Path(self.test_local) / "partial_put.txt"
+        local_file.write_text("first half, second half\n")
+        server_file = Path(self.test_root) / "partial_put.txt"
+        server_file.write_text("first half, ")
+        result = self.run_ftp_interactive(
+            [f"put -a {local_file} partial_put.txt"])
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("Uploaded", result.stdout)
+        self.assertEqual(server_file.read_text(), "first half, second half\n")
+
+    def test_get_to_stdout(self):
+        """Test a one-shot get - writes only the file to stdout."""
+        result = self.run_ftp("-H", "localhost", "-p", str(self.SERVER_PORT),
+                              "get", "serverfile.txt", "-")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, "Server content\n")
+        self.assertIn("Connected", result.stderr)
+
+    def test_put_from_stdin(self):
+        """Test a one-shot put - uploads what arrives on stdin."""
+        result = self.run_ftp("-H", "localhost", "-p", str(self.SERVER_PORT),
+                              "put", "-", "from_stdin.txt",
+                              input_data="Piped content\n")
+        self.assertEqual(result.returncode, 0)
+        server_file = Path(self.test_root) / "from_stdin.txt"
+        self.assertEqual(server_file.read_text(), "Piped content\n")
+
+    def test_put_stdin_needs_remote(self):
+        """Test put - without a remote name fails."""
+        result = self.run_ftp("-H", "localhost", "-p", str(self.SERVER_PORT),
+                              "put", "-", input_data="data\n")
+        self.assertNotEqual(result.returncode, 0)
+        self.assertIn("remote name required", result.stderr)
+
+    def test_put_stdin_interactive(self):
+        """Test put - is refused while stdin carries the commands."""
+        result = self.run_ftp_interactive(["put - nope.txt"])
+        self.assertIn("stdin holds the commands", result.stderr)
+        self.assertFalse((Path(self.test_root) / "nope.txt").exists())
+
     def test_put_missing_arg(self):
         """Test put command without argument shows error."""
         result = self.run_ftp_interactive(["put"], json_output=False)
         self.assertEqual(result.returncode, 0)
         self.assertIn("missing", result.stderr.lower())
 
+    def test_compress_get_and_put(self):
+        """Test --compress moves files intact over MODE Z, large ones
+        deflated on several threads."""
+        text = "".join(f"row {i} of a compressible table\n"
+                       for i in range(200000))
+        local_dir = Path(self.test_local) / "compress"
+        local_dir.mkdir()
+        (local_dir / "table.txt").write_text(text)
+        (local_dir / "packed.gz").write_bytes(os.urandom(100000))
+        result = self.run_ftp(
+            "-H", "localhost", "-p", str(self.SERVER_PORT), "--compress",
+            input_data="put table.txt\nput packed.gz\n"
+                       "get table.txt back.txt\nls\nquit\n",
+            cwd=local_dir, timeout=30)
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stderr, "")
+        self.assertEqual((Path(self.test_root) / "table.txt").read_text(),
+                         text)
+        self.assertEqual((Path(self.test_root) / "packed.gz").read_bytes(),
+                         (local_dir / "packed.gz").read_bytes())
+        self.assertEqual((local_dir / "back.txt").read_text(), text)
+        self.assertIn("serverfile.txt", result.stdout)
+
+    def test_compress_stdio_and_segments(self):
+        """Test --compress with stdin, stdout and segmented mget."""
+        result = self.run_ftp("-H", "localhost", "-p", str(self.SERVER_PORT),
+                              "-z", "put", "-", "z_stdin.txt",
+                              input_data="Piped and deflated\n")
+        self.assertEqual(result.returncode, 0)
+        result = self.run_ftp("-H", "localhost", "-p", str(self.SERVER_PORT),
+                              "-z", "get", "z_stdin.txt", "-")
+        self.assertEqual(result.stdout, "Piped and deflated\n")
+
+        data = os.urandom(1024 * 1024) * 18
+        (Path(self.test_root) / "z_large.bin").write_bytes(data)
+        local_dir = Path(self.test_local) / "z_segments"
+        local_dir.mkdir()
+        result = self.run_ftp(
+            "-H", "localhost", "-p", str(self.SERVER_PORT), "-z",
+            input_data="mget -n 4 z_large.bin\nquit\n",
+            cwd=local_dir, timeout=60)
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual((local_dir / "z_large.bin").read_bytes(), data)
+
+    def test_keep_reuses_session(self):
+        """Test --keep hands the session on to the next command, back in
+        its home directory, until it has been idle too long."""
+        pool_dir = tempfile.mkdtemp(prefix="ftp_pool_")
+        self.addCleanup(shutil.rmtree, pool_dir, ignore_errors=True)
+        env = {"TMPDIR": pool_dir}
+        server = ["-H", "localhost", "-p", str(self.SERVER_PORT), "-k", "2"]
+
+        result = self.run_ftp(*server, "cd", "subdir", env=env)
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("Connecting", result.stderr)
+
+        result = self.run_ftp(*server, "get", "subdir/nested.txt", "-",
+                              env=env)
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("Reusing session", result.stderr)
+        self.assertEqual(result.stdout, "Nested\n")
+
+        result = self.run_ftp(*server, "-z", "get", "serverfile.txt", "-",
+                              env=env)
+        self.assertIn("Reusing session", result.stderr)
+        self.assertEqual(result.stdout, "Server content\n")
+
+        # Another user gets a session of its own
+        result = self.run_ftp(*server, "-u", "other", "pwd", env=env)
+        self.assertIn("Connecting", result.stderr)
+
+        # The keeper quits the sessions and exits once idle
+        sock = Path(pool_dir) / f"jbox-ftp-{os.getuid()}.sock"
+        self.assertTrue(sock.exists())
+        deadline = time.monotonic() + 10
+        while sock.exists() and time.monotonic() < deadline:
+            time.sleep(0.2)
+        self.assertFalse(sock.exists())
+
+    def test_mget_parallel(self):
+        """Test mget downloads several files over parallel sessions."""
+        names = [f"many_{i}.txt" for i in range(6)]
+        for name in names:
+            (Path(self.test_root) / name).write_text(f"content of {name}\n")
+        local_dir = Path(self.test_local) / "mget"
+        local_dir.mkdir()
+        result = self.run_ftp(
+            "-H", "localhost", "-p", str(self.SERVER_PORT), "--json",
+            input_data="mget -n 3 " + " ".join(names) + "\nquit\n",
+            cwd=local_dir)
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(
+            result.stdout.count('"action":"mget","status":"ok"'), 6)
+        for name in names:
+            self.assertEqual((local_dir / name).read_text(),
+                             f"content of {name}\n")
+
+    def test_mget_segmented(self):
+        """Test mget splits a large file into segments fetched at once."""
+        data = os.urandom(20 * 1024 * 1024 + 12345)
+        (Path(self.test_root) / "large.bin").write_bytes(data)
+        local_dir = Path(self.test_local) / "segments"
+        local_dir.mkdir()
+        result = self.run_ftp(
+            "-H", "localhost", "-p", str(self.SERVER_PORT),
+            input_data="mget -n 4 large.bin serverfile.txt\nquit\n",
+            cwd=local_dir, timeout=60)
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("Downloaded large.bin -> large.bin", result.stdout)
+        self.assertEqual((local_dir / "large.bin").read_bytes(), data)
+        self.assertEqual((local_dir / "serverfile.txt").read_text(),
+                         "Server content\n")
+
+    def test_mget_missing_file(self):
+        """Test mget reports a missing file and still fetches the rest."""
+        local_dir = Path(self.test_local) / "mget_missing"
+        local_dir.mkdir()
+        result = self.run_ftp(
+            "-H", "localhost", "-p", str(self.SERVER_PORT),
+            input_data="mget nosuchfile serverfile.txt\nquit\n",
+            cwd=local_dir)
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("mget nosuchfile failed", result.stderr)
+        self.assertTrue((local_dir / "serverfile.txt").exists())
+
+    def test_mput_parallel(self):
+        """Test mput uploads several files over parallel sessions."""
+        paths = []
+        for i in range(5):
+            path = Path(self.test_local) / f"up_many_{i}.txt"
+            path.write_text(f"upload {i}\n")
+            paths.append(str(path))
+        result = self.run_ftp_interactive(
+            ["cd subdir", "mput -n 2 " + " ".join(paths)])
+        self.assertEqual(result.returncode, 0)
+        for i in range(5):
+            self.assertEqual(
+                (Path(self.test_root) / "subdir" / f"up_many_{i}.txt")
+                .read_text(), f"upload {i}\n")
+
+    def test_mput_bad_session_count(self):
+        """Test mput rejects an invalid number of sessions."""
+        result = self.run_ftp_interactive(["mput -n 0 x"])
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("invalid number of sessions", result.stderr)
+
     # === Directory operations ===
 
+    def test_mirror_pull(self):
+        """Test mirror fetches a tree, then only what changed."""
+        tree = Path(self.test_root) / "mirror_src"
+        (tree / "sub").mkdir(parents=True)
+        (tree / "one.txt").write_text("one\n")
+        (tree / "sub" / "two.txt").write_text("two\n")
+        local = Path(self.test_local) / "mirror_dst"
+        args = ["-H", "localhost", "-p", str(self.SERVER_PORT), "--json",
+                "mirror", "mirror_src", str(local)]
+
+        result = self.run_ftp(*args)
+        self.assertEqual(result.returncode, 0, result.stderr)
+        self.assertIn('"transferred":2', result.stdout)
+        self.assertEqual((local / "sub" / "two.txt").read_text(), "two\n")
+
+        result = self.run_ftp(*args)
+        self.assertIn('"transferred":0', result.stdout)
+        self.assertIn('"unchanged":2', result.stdout)
+
+        (tree / "one.txt").write_text("one, longer\n")
+        (local / "extra.txt").write_text("extra\n")
+        result = self.run_ftp(*args[:-2], "--delete", *args[-2:])
+        self.assertIn('"transferred":1', result.stdout)
+        self.assertIn('"deleted":1', result.stdout)
+        self.assertEqual((local / "one.txt").read_text(), "one, longer\n")
+        self.assertFalse((local / "extra.txt").exists())
+
+    def test_mirror_checksum(self):
+        """Test mirror --checksum finds a change that keeps size and time."""
+        tree = Path(self.test_root) / "mirror_sum"
+        tree.mkdir()
+        (tree / "f.txt").write_text("abc\n")
+        local = Path(self.test_local) / "mirror_sum"
+        args = ["-H", "localhost", "-p", str(self.SERVER_PORT), "--json",
+                "mirror", "mirror_sum", str(local)]
+        self.run_ftp(*args)
+        (local / "f.txt").write_text("xyz\n")
+        mtime = (tree / "f.txt").stat().st_mtime
+        os.utime(local / "f.txt", (mtime, mtime))
+
+        result = self.run_ftp(*args)
+        self.assertIn('"transferred":0', result.stdout)
+        result = self.run_ftp(*args[:-2], "--checksum", *args[-2:])
+        self.assertIn('"transferred":1', result.stdout)
+        self.assertEqual((local / "f.txt").read_text(), "abc\n")
+
+    def test_mirror_push(self):
+        """Test mirror -R uploads a tree and removes what it lacks."""
+        local = Path(self.test_local) / "mirror_up"
+        (local / "d").mkdir(parents=True)
+        (local / "d" / "f.txt").write_text("up\n")
+        args = ["-H", "localhost", "-p", str(self.SERVER_PORT),
+                "mirror", "-R", "mirror_up", str(local)]
+        result = self.run_ftp(*args)
+        self.assertEqual(result.returncode, 0, result.stderr)
+        remote = Path(self.test_root) / "mirror_up"
+        self.assertEqual((remote / "d" / "f.txt").read_text(), "up\n")
+
+        shutil.rmtree(local / "d")
+        (local / "g.txt").write_text("g\n")
+        result = self.run_ftp(*args[:-2], "--delete", *args[-2:])
+        self.assertEqual(result.returncode, 0, result.stderr)
+        self.assertFalse((remote / "d").exists())
+        self.assertEqual((remote / "g.txt").read_text(), "g\n")
+
+    def test_mirror_missing_source(self):
+        """Test mirror of a missing remote directory fails."""
+        result = self.run_ftp("-H", "localhost", "-p", str(self.SERVER_PORT),
+                              "mirror", "no_such_dir",
+                              str(Path(self.test_local) / "nothing"))
+        self.assertNotEqual(result.returncode, 0)
+        self.assertIn("mirror", result.stderr)
+
+    def test_batch_pipelined_mkdir(self):
+        """Test a batch script pipelines mkdir and cd and reports in order."""
+        lines = ["# make a tree", "mkdir batch", "cd batch"]
+        lines += [f"mkdir d{i}" for i in range(300)]
+        lines += ["mkdir d7", "cd d299", "mkdir leaf", "pwd"]
+        script = Path(self.test_local) / "batch.txt"
+        script.write_text("\n".join(lines) + "\n")
+        result = self.run_ftp("-H", "localhost", "-p", str(self.SERVER_PORT),
+                              "-b", str(script), "--json", timeout=30)
+        self.assertEqual(result.returncode, 0, result.stderr)
+
+        out = result.stdout.splitlines()
+        reports = [line for line in out
+                   if '"action":"mkdir"' in line or '"action":"cd"' in line]
+        self.assertEqual(len(reports), 305)
+        self.assertIn('"dir":"batch"', reports[0])
+        self.assertIn('"dir":"d0"', reports[2])
+        self.assertIn('"dir":"d299"', reports[301])
+        self.assertIn('"status":"error"', reports[302])
+        self.assertIn('"path":"/batch/d299"', out[-1])
+
+        root = Path(self.test_root) / "batch"
+        for i in range(300):
+            self.assertTrue((root / f"d{i}").is_dir())
+        self.assertTrue((root / "d299" / "leaf").is_dir())
+
+    def test_batch_stdin(self):
+        """Test a batch read from stdin runs transfers between mkdirs."""
+        local_dir = Path(self.test_local) / "batch_stdin"
+        local_dir.mkdir()
+        result = self.run_ftp(
+            "-H", "localhost", "-p", str(self.SERVER_PORT), "-b", "-",
+            input_data="mkdir bs1\nget serverfile.txt\nmkdir bs2\n",
+            cwd=local_dir)
+        self.assertEqual(result.returncode, 0, result.stderr)
+        self.assertNotIn("ftp>", result.stdout)
+        out = result.stdout
+        self.assertLess(out.index("Created directory bs1"),
+                        out.index("Downloaded serverfile.txt"))
+        self.assertLess(out.index("Downloaded serverfile.txt"),
+                        out.index("Created directory bs2"))
+        self.assertTrue((local_dir / "serverfile.txt").exists())
+
+    def test_batch_missing_file(self):
+        """Test a missing batch script fails before connecting."""
+        result = self.run_ftp("-H", "localhost", "-p", str(self.SERVER_PORT),
+                              "-b", "/nonexistent/script")
+        self.assertEqual(result.returncode, 1)
+        self.assertIn("cannot open", result.stderr)
+        self.assertNotIn("Connecting", result.stdout)
+
     def test_mkdir_command(self):
         """Test mkdir command creates directory."""
         result = self.run_ftp_interactive(["mkdir newdir"], json_output=False)
@@ -342,5 +717,131 @@ class FtpClientTestCase(unittest.TestCase):
         self.assertIn('"status":"ok"', result.stdout)
 
 
+class FtpClientTlsTestCase(unittest.TestCase):
+    """Test cases for the FTP client over AUTH TLS."""
+
+    FTP_BIN = FtpClientTestCase.FTP_BIN
+    FTPD_BIN = FtpClientTestCase.FTPD_BIN
+    SERVER_PORT = 21622
+    server_proc = None
+    test_root = None
+    test_local = None
+    cert = None
+
+    @classmethod
+    def setUpClass(cls):
+        """Start the FTP server with a self-signed certificate."""
+        if not cls.FTP_BIN.exists():
+            raise unittest.SkipTest(f"ftp client not found at {cls.FTP_BIN}")
+        if not cls.FTPD_BIN.exists():
+            raise unittest.SkipTest(f"ftpd server not found at {cls.FTPD_BIN}")
+        if not shutil.which("openssl"):
+            raise unittest.SkipTest("openssl not found")
+
+        cls.test_root = tempfile.mkdtemp(prefix="ftp_client_tls_server_")
+        cls.test_local = tempfile.mkdtemp(prefix="ftp_client_tls_local_")
+        (Path(cls.test_root) / "serverfile.txt").write_text("Server content\n")
+
+        cls.cert = str(Path(cls.test_local) / "cert.pem")
+        subprocess.run(
+            ["openssl", "req", "-x509", "-newkey", "ec",
+             "-pkeyopt", "ec_paramgen_curve:prime256v1", "-nodes",
+             "-keyout", cls.cert, "-out", cls.cert, "-days", "1",
+             "-subj", "/CN=localhost",
+             "-addext", "subjectAltName=DNS:localhost,IP:127.0.0.1"],
+            check=True, capture_output=True)
+
+        cls.server_proc = subprocess.Popen(
+            [str(cls.FTPD_BIN), "-p", str(cls.SERVER_PORT),
+             "-r", cls.test_root, "--tls-cert", cls.cert],
+            stdout=subprocess.PIPE,
+            stderr=subprocess.PIPE,
+            env={**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
+        )
+        time.sleep(0.3)
+        if cls.server_proc.poll() is not None:
+            stdout, stderr = cls.server_proc.communicate()
+            raise unittest.SkipTest(
+                f"ftpd failed to start: {stderr.decode()}"
+            )
+
+    @classmethod
+    def tearDownClass(cls):
+        """Stop the FTP server and clean up."""
+        if cls.server_proc:
+            cls.server_proc.terminate()
+            try:
+                cls.server_proc.wait(timeout=2)
+            except subprocess.TimeoutExpired:
+                cls.server_proc.kill()
+                cls.server_proc.wait()
+        if cls.test_root:
+            shutil.rmtree(cls.test_root, ignore_errors=True)
+        if cls.test_local:
+            shutil.rmtree(cls.test_local, ignore_errors=True)
+
+    def run_ftps(self, commands, *extra, cwd=None, timeout=30):
+        """Run the FTP client over TLS with interactive commands."""
+        cmd = [str(self.FTP_BIN), "-H", "localhost",
+               "-p", str(self.SERVER_PORT), "--tls"] + list(extra)
+        return subprocess.run(
+            cmd,
+            input="\n".join(commands) + "\nquit\n",
+            capture_output=True,
+            text=True,
+            timeout=timeout,
+            cwd=cwd,
+            env={**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
+        )
+
+    def test_tls_get(self):
+        """Test get over a protected data connection."""
+        local_dir = Path(self.test_local) / "get"
+        local_dir.mkdir()
+        result = self.run_ftps(["get serverfile.txt"],
+                               "--tls-ca", self.cert, cwd=local_dir)
+        self.assertEqual(result.returncode, 0, result.stderr)
+        self.assertIn("Secured with TLSv1.", result.stdout)
+        self.assertEqual((local_dir / "serverfile.txt").read_text(),
+                         "Server content\n")
+
+    def test_tls_put_json(self):
+        """Test put over TLS, reporting the protocol in JSON."""
+        data = os.urandom(256 * 1024 + 7)
+        local = Path(self.test_local) / "upload.bin"
+        local.write_bytes(data)
+        result = self.run_ftps([f"put {local}"], "--tls-ca", self.cert,
+                               "--json")
+        self.assertEqual(result.returncode, 0, result.stderr)
+        self.assertIn('"action":"auth","status":"ok","protocol":"TLSv1.',
+                      result.stdout)
+        self.assertEqual((Path(self.test_root) / "upload.bin").read_bytes(),
+                         data)
+
+    def test_tls_mget(self):
+        """Test mget sessions secure themselves and resume the session."""
+        names = [f"secure_{i}.txt" for i in range(4)]
+        for name in names:
+            (Path(self.test_root) / name).write_text(f"secret {name}\n")
+        local_dir = Path(self.test_local) / "mget"
+        local_dir.mkdir()
+        result = self.run_ftps(["mget -n 2 " + " ".join(names)],
+                               "--tls-ca", self.cert, cwd=local_dir)
+        self.assertEqual(result.returncode, 0, result.stderr)
+        for name in names:
+            self.assertEqual((local_dir / name).read_text(),
+                             f"secret {name}\n")
+
+    def test_tls_untrusted_certificate(self):
+        """Test an unverifiable certificate fails unless --insecure."""
+        result = self.run_ftps([], "--tls-ca", "/dev/null")
+        self.assertNotEqual(result.returncode, 0)
+        self.assertIn("TLS failed", result.stderr)
+
+        result = self.run_ftps(["pwd"], "--insecure")
+        self.assertEqual(result.returncode, 0, result.stderr)
+        self.assertIn("Secured with", result.stdout)
+
+
 if __name__ == "__main__":
     unittest.main()
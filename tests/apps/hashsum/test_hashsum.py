@@ -0,0 +1,181 @@
+#!/usr/bin/env python3
+"""Unit tests for the hashsum command."""
+
+import hashlib
+import json
+import os
+import subprocess
+import tempfile
+import unittest
+from pathlib import Path
+
+
+def pattern(n):
+    """The input of the BLAKE3 test vectors: bytes counting modulo 251."""
+    return bytes(i % 251 for i in range(n))
+
+
+# Digests from the BLAKE3 reference test vectors
+BLAKE3_VECTORS = {
+    0: "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262",
+    1: "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213",
+    1023: "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11",
+    1024: "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7",
+    1025: "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444",
+    2048: "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a",
+    102400: "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085",
+}
+
+
+class TestHashsumCommand(unittest.TestCase):
+    """Test cases for the hashsum command."""
+
+    HASHSUM_BIN = Path(__file__).parent.parent.parent.parent / "bin" / "standalone-apps" / "hashsum"
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the hashsum binary exists before running tests."""
+        if not cls.HASHSUM_BIN.exists():
+            raise unittest.SkipTest(f"hashsum binary not found at {cls.HASHSUM_BIN}")
+
+    def setUp(self):
+        self.tmpdir = tempfile.TemporaryDirectory()
+        self.root = self.tmpdir.name
+
+    def tearDown(self):
+        self.tmpdir.cleanup()
+
+    def write(self, name, data):
+        Path(self.root, name).write_bytes(data)
+        return name
+
+    def run_hashsum(self, *args, input=None):
+        """Run the hashsum command with given arguments and return result."""
+        cmd = [str(self.HASHSUM_BIN)] + list(args)
+        result = subprocess.run(
+            cmd,
+            input=input,
+            capture_output=True,
+            cwd=self.root,
+            env={**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
+        )
+        return result
+
+    def test_help(self):
+        """Test --help shows usage."""
+        result = self.run_hashsum("--help")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn(b"Usage: hashsum", result.stdout)
+
+    def test_sha256_matches_hashlib(self):
+        """Test SHA-256 digests across block and padding boundaries."""
+        names = []
+        for n in (0, 1, 55, 56, 63, 64, 65, 1000, 100003):
+            names.append(self.write(f"f{n}", os.urandom(n)))
+        result = self.run_hashsum(*names)
+        self.assertEqual(result.returncode, 0)
+        expected = "".join(
+            f"{hashlib.sha256(Path(self.root, n).read_bytes()).hexdigest()}  {n}\n"
+            for n in names)
+        self.assertEqual(result.stdout.decode(), expected)
+
+    def test_blake3_vectors(self):
+        """Test BLAKE3 digests against the reference test vectors."""
+        for n, digest in BLAKE3_VECTORS.items():
+            name = self.write(f"v{n}", pattern(n))
+            result = self.run_hashsum("-a", "blake3", name)
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(result.stdout.decode(), f"{digest}  {name}\n")
+
+    def test_blake3_split_across_subtrees(self):
+        """Test a file large enough to be hashed as several subtrees."""
+        name = self.write("big", pattern(3 * 1024 * 1024 + 5))
+        result = self.run_hashsum("-a", "blake3", name)
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(
+            result.stdout.decode(),
+            "a7bb55bed0c04f58879d1fc1cafb27e14e931f4411fe63baf5b2d5a60357bffb  big\n")
+
+    def test_blake3_stdin_matches_file(self):
+        """Test that a stream hashes the same as the mapped file."""
+        data = pattern(3 * 1024 * 1024 + 5)
+        name = self.write("big", data)
+        mapped = self.run_hashsum("-a", "blake3", name)
+        streamed = self.run_hashsum("-a", "blake3", input=data)
+        self.assertEqual(streamed.returncode, 0)
+        self.assertEqual(streamed.stdout.split()[0], mapped.stdout.split()[0])
+        self.assertEqual(streamed.stdout.split()[1], b"-")
+
+    def test_order_kept(self):
+        """Test that digests print in argument order, large files first too."""
+        big = self.write("big", os.urandom(5 * 1024 * 1024))
+        small = self.write("small", b"x")
+        result = self.run_hashsum("-a", "blake3", big, small, big)
+        lines = result.stdout.decode().splitlines()
+        self.assertEqual([line.split("  ")[1] for line in lines],
+                         ["big", "small", "big"])
+        self.assertEqual(lines[0], lines[2])
+
+    def test_json(self):
+        """Test --json output."""
+        name = self.write("a", b"hello\n")
+        result = self.run_hashsum("--json", name)
+        self.assertEqual(result.returncode, 0)
+        data = json.loads(result.stdout)
+        self.assertEqual(data, [{
+            "file": "a",
+            "algorithm": "sha256",
+            "hash": hashlib.sha256(b"hello\n").hexdigest(),
+        }])
+
+    def test_check(self):
+        """Test -c reports OK and FAILED, and exits 1 on a mismatch."""
+        a = self.write("a", b"one\n")
+        b = self.write("b", b"two\n")
+        sums = self.run_hashsum(a, b).stdout
+        self.write("SUMS", sums)
+        result = self.run_hashsum("-c", "SUMS")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, b"a: OK\nb: OK\n")
+
+        self.write("b", b"changed\n")
+        result = self.run_hashsum("-c", "SUMS")
+        self.assertEqual(result.returncode, 1)
+        self.assertEqual(result.stdout, b"a: OK\nb: FAILED\n")
+        self.assertIn(b"1 computed checksum did NOT match", result.stderr)
+
+    def test_check_reads_sha256sum_format(self):
+        """Test -c accepts sha256sum's binary marker and uppercase hex."""
+        self.write("a", b"data")
+        digest = hashlib.sha256(b"data").hexdigest().upper()
+        self.write("SUMS", f"{digest} *a\nnot a digest line\n".encode())
+        result = self.run_hashsum("-c", "--json", "SUMS")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(json.loads(result.stdout)[0]["ok"], True)
+        self.assertIn(b"1 line is improperly formatted", result.stderr)
+
+    def test_missing_file(self):
+        """Test a missing file is reported and the rest still hashed."""
+        name = self.write("a", b"x")
+        result = self.run_hashsum("nope", name)
+        self.assertEqual(result.returncode, 1)
+        self.assertIn(b"hashsum: nope:", result.stderr)
+        self.assertEqual(result.stdout.split()[1], b"a")
+
+    def test_directory(self):
+        """Test a directory is an error."""
+        Path(self.root, "d").mkdir()
+        result = self.run_hashsum("d")
+        self.assertEqual(result.returncode, 1)
+        self.assertIn(b"Is a directory", result.stderr)
+
+    def test_unknown_algorithm(self):
+        """Test an unknown algorithm is rejected."""
+        result = self.run_hashsum("-a", "md5")
+        self.assertEqual(result.returncode, 1)
+        self.assertIn(b"unknown algorithm", result.stderr)
+        self.assertIn(b"Try 'hashsum --help'", result.stderr)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -266,6 +266,56 @@ class TestHeadCommand(unittest.TestCase):
         finally:
             os.unlink(temp_path)
 
+    def test_lines_spanning_read_blocks(self):
+        """Test that lines longer than a read block are output whole."""
+        long_line = "x" * 200000
+        with tempfile.NamedTemporaryFile(mode="w", delete=False) as f:
+            f.write(long_line + "\n" + long_line + "y\nlast\n")
+            temp_path = f.name
+
+        try:
+            result = self.run_head("-n", "2", temp_path)
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(result.stdout,
+                             long_line + "\n" + long_line + "y\n")
+        finally:
+            os.unlink(temp_path)
+
+    def test_bytes(self):
+        """Test -c outputs the first BYTES bytes, newlines included."""
+        with tempfile.NamedTemporaryFile(mode="w", delete=False) as f:
+            f.write("line1\nline2\nline3\n")
+            temp_path = f.name
+
+        try:
+            result = self.run_head("-c", "8", temp_path)
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(result.stdout, "line1\nli")
+
+            result = self.run_head("-c", "1000", temp_path)
+            self.assertEqual(result.stdout, "line1\nline2\nline3\n")
+        finally:
+            os.unlink(temp_path)
+
+    def test_json_bytes(self):
+        """Test --json with -c outputs the bytes as one data string."""
+        with tempfile.NamedTemporaryFile(mode="w", delete=False) as f:
+            f.write("a\tb\nc\n")
+            temp_path = f.name
+
+        try:
+            result = self.run_head("--json", "-c", "5", temp_path)
+            self.assertEqual(result.returncode, 0)
+            data = json.loads(result.stdout)
+            self.assertEqual(data["data"], "a\tb\nc")
+        finally:
+            os.unlink(temp_path)
+
+    def test_bytes_and_lines_conflict(self):
+        """Test that -n and -c cannot be combined."""
+        result = self.run_head("-n", "2", "-c", "5", "/tmp/somefile")
+        self.assertNotEqual(result.returncode, 0)
+
     def test_file_with_no_trailing_newline(self):
         """Test file without trailing newline."""
         with tempfile.NamedTemporaryFile(mode="w", delete=False) as f:
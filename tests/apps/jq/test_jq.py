@@ -0,0 +1,188 @@
+#!/usr/bin/env python3
+"""Unit tests for the jq command."""
+
+import json
+import os
+import subprocess
+import tempfile
+import unittest
+from pathlib import Path
+
+
+class TestJqCommand(unittest.TestCase):
+    """Test cases for the jq command."""
+
+    JQ_BIN = Path(__file__).parent.parent.parent.parent / "bin" / "standalone-apps" / "jq"
+
+    FILES = [
+        {"name": "a.txt", "size": 120, "tags": ["x", "y"],
+         "meta": {"owner": "bob", "mode": 420}},
+        {"name": "b \"q\" \\ ]}", "size": 5, "tags": [],
+         "meta": {"owner": "amy", "mode": 493}},
+        {"name": "c", "size": 9000, "tags": ["z"], "meta": None},
+    ]
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the jq binary exists before running tests."""
+        if not cls.JQ_BIN.exists():
+            raise unittest.SkipTest(f"jq binary not found at {cls.JQ_BIN}")
+
+    def setUp(self):
+        self.tmpdir = tempfile.TemporaryDirectory()
+        self.root = self.tmpdir.name
+        Path(self.root, "files.json").write_text(
+            json.dumps(self.FILES, indent=2) + "\n")
+        Path(self.root, "files.ndjson").write_text(
+            "".join(json.dumps(f) + "\n" for f in self.FILES))
+
+    def tearDown(self):
+        self.tmpdir.cleanup()
+
+    def run_jq(self, *args, input=None):
+        """Run the jq command with given arguments and return result."""
+        cmd = [str(self.JQ_BIN)] + list(args)
+        result = subprocess.run(
+            cmd,
+            input=input,
+            capture_output=True,
+            text=True,
+            cwd=self.root,
+            env={**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
+        )
+        return result
+
+    def outputs(self, result):
+        """Parse compact output into a list of values."""
+        return [json.loads(line) for line in result.stdout.splitlines()]
+
+    def test_help(self):
+        """Test --help shows usage."""
+        result = self.run_jq("--help")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("Usage: jq", result.stdout)
+
+    def test_identity_pretty(self):
+        """Test . prints the input indented by two spaces."""
+        result = self.run_jq(".", input='{"a":[1,{"b":null}],"c":{}}')
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout,
+                         '{\n  "a": [\n    1,\n    {\n      "b": null\n'
+                         '    }\n  ],\n  "c": {}\n}\n')
+
+    def test_paths(self):
+        """Test fields, indexes and iteration."""
+        result = self.run_jq("-c", '.[1].name, .[-1].size, .[0].tags[],'
+                             ' .[0]["meta"].owner, .[5]', "files.json")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(self.outputs(result),
+                         ['b "q" \\ ]}', 9000, "x", "y", "bob", None])
+
+    def test_select_streams_array(self):
+        """Test .[] | select(...) over a top-level array."""
+        result = self.run_jq("-r", ".[] | select(.size > 100) | .name",
+                             "files.json")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, "a.txt\nc\n")
+
+    def test_ndjson(self):
+        """Test each NDJSON line is its own input, CRLF included."""
+        result = self.run_jq("-c", "{name, owner: .meta.owner}",
+                             "files.ndjson")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(self.outputs(result), [
+            {"name": f["name"],
+             "owner": f["meta"]["owner"] if f["meta"] else None}
+            for f in self.FILES])
+        result = self.run_jq("-c", ".a", input='{"a":1}\r\n{"a":2} 3 "s"')
+        self.assertEqual(result.stdout, "1\n2\n")
+        self.assertEqual(result.returncode, 1)
+
+    def test_construction(self):
+        """Test array and object construction, map and add."""
+        result = self.run_jq("-c", "(map(.size) | add), [.[].tags | length],"
+                             " {(.[0].name): .[0].size}", "files.json")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(self.outputs(result),
+                         [9125, [2, 0, 1], {"a.txt": 120}])
+
+    def test_operators(self):
+        """Test arithmetic, comparison and boolean operators."""
+        result = self.run_jq(
+            "-n", "-c", '1 + 2 * 3, 7 % 3, "a" + "b", [1,2,3] - [2],'
+            ' {a:1} + {b:2}, "a,b" / ",", 1 < 2 and null, null // "d",'
+            ' [1, "a", null] == [1, "a", null]')
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(self.outputs(result),
+                         [7, 1, "ab", [1, 3], {"a": 1, "b": 2}, ["a", "b"],
+                          False, "d", True])
+
+    def test_if_and_builtins(self):
+        """Test if/elif/else and the string and type builtins."""
+        result = self.run_jq(
+            "-c", '.[] | [if .size > 1000 then "big" elif .size > 100 then'
+            ' "mid" else "small" end, (.meta | type), has("tags"),'
+            ' (.name | startswith("a")), (.tags | contains(["x"])),'
+            ' (.name | ascii_upcase), (.size | tostring)]', "files.json")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(self.outputs(result), [
+            ["mid", "object", True, True, True, "A.TXT", "120"],
+            ["small", "object", True, False, False, 'B "Q" \\ ]}', "5"],
+            ["big", "null", True, False, False, "C", "9000"],
+        ])
+
+    def test_keys_and_numbers(self):
+        """Test keys are sorted and input numbers print as written."""
+        result = self.run_jq("-c", "keys, .n, .n + 0",
+                             input='{"z":1,"a":2,"n":1.50}')
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, '["a","n","z"]\n1.50\n1.5\n')
+
+    def test_errors_continue(self):
+        """Test a runtime error is reported and later inputs still run."""
+        result = self.run_jq("-c", ".a", input='{"a":1} [2] {"a":3}')
+        self.assertEqual(result.returncode, 1)
+        self.assertEqual(result.stdout, "1\n3\n")
+        self.assertIn("Cannot index array", result.stderr)
+        result = self.run_jq("-c", ".a?", input='{"a":1} [2] {"a":3}')
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, "1\n3\n")
+
+    def test_invalid_json(self):
+        """Test truncated and malformed input fail."""
+        result = self.run_jq(".", input='{"a": [1, 2')
+        self.assertEqual(result.returncode, 1)
+        self.assertIn("unexpected end", result.stderr)
+        result = self.run_jq(".[]", input="[1 2]")
+        self.assertEqual(result.returncode, 1)
+        self.assertIn("invalid JSON", result.stderr)
+
+    def test_syntax_error(self):
+        """Test a bad filter fails before reading input."""
+        result = self.run_jq(".a |", "files.json")
+        self.assertEqual(result.returncode, 1)
+        self.assertIn("syntax error", result.stderr)
+        self.assertEqual(result.stdout, "")
+        result = self.run_jq("frobnicate", "files.json")
+        self.assertEqual(result.returncode, 1)
+        self.assertIn("unknown function", result.stderr)
+
+    def test_missing_file(self):
+        """Test a missing FILE is reported and the others are read."""
+        result = self.run_jq("-c", ".[0].size", "missing.json", "files.json")
+        self.assertEqual(result.returncode, 1)
+        self.assertIn("missing.json", result.stderr)
+        self.assertEqual(result.stdout, "120\n")
+
+    def test_large_array(self):
+        """Test a large array streamed through .[] with projection."""
+        items = [{"id": i, "pad": "x\\\"]" * (i % 50), "odd": i % 2 == 1}
+                 for i in range(20000)]
+        Path(self.root, "big.json").write_text(json.dumps(items))
+        result = self.run_jq("-c", ".[] | select(.odd) | .id", "big.json")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(self.outputs(result), list(range(1, 20000, 2)))
+
+
+if __name__ == "__main__":
+    unittest.main()
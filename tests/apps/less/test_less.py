@@ -1,7 +1,9 @@
 #!/usr/bin/env python3
 """Unit tests for the less command."""
 
+import gzip
 import os
+import shutil
 import subprocess
 import tempfile
 import unittest
@@ -175,6 +177,112 @@ class TestLessCommand(unittest.TestCase):
         finally:
             os.unlink(temp_path)
 
+    def test_stdin_input(self):
+        """Test reading content piped on stdin."""
+        result = self.run_less(stdin_data="from a pipe\nsecond line\n")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, "from a pipe\nsecond line\n")
+
+    def test_output_matches_file(self):
+        """Test non-interactive output is the file plus a final newline."""
+        with tempfile.NamedTemporaryFile(mode="w", delete=False) as f:
+            f.write("first\n\nthird\nlast without newline")
+            temp_path = f.name
+
+        try:
+            result = self.run_less(temp_path)
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(result.stdout,
+                             "first\n\nthird\nlast without newline\n")
+        finally:
+            os.unlink(temp_path)
+
+    def test_line_numbers_many_lines(self):
+        """Test -N numbers every line of a file with many lines."""
+        with tempfile.NamedTemporaryFile(mode="w", delete=False) as f:
+            f.write("".join(f"row {i}\n" for i in range(1, 1001)))
+            temp_path = f.name
+
+        try:
+            result = self.run_less("-N", temp_path)
+            self.assertEqual(result.returncode, 0)
+            lines = result.stdout.splitlines()
+            self.assertEqual(len(lines), 1000)
+            self.assertEqual(lines[0], "     1  row 1")
+            self.assertEqual(lines[999], "  1000  row 1000")
+        finally:
+            os.unlink(temp_path)
+
+    def test_ignore_case_option(self):
+        """Test -i is accepted and does not change non-interactive output."""
+        result = self.run_less("-i", stdin_data="Mixed Case\n")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, "Mixed Case\n")
+
+    def test_fifo_input(self):
+        """Test reading a named pipe, which cannot be mapped."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            fifo = Path(tmpdir, "fifo")
+            os.mkfifo(fifo)
+            proc = subprocess.Popen(
+                [str(self.LESS_BIN), str(fifo)],
+                stdout=subprocess.PIPE,
+                text=True,
+                env={**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
+            )
+            with open(fifo, "w") as writer:
+                for i in range(2000):
+                    writer.write(f"streamed {i}\n")
+            out, _ = proc.communicate(timeout=10)
+            self.assertEqual(proc.returncode, 0)
+            self.assertEqual(out.splitlines(),
+                             [f"streamed {i}" for i in range(2000)])
+    def test_gzip_file(self):
+        """Test a gzip file, of several members, is shown decompressed."""
+        text = "".join(f"log line {i}\n" for i in range(50000))
+        with tempfile.NamedTemporaryFile(delete=False, suffix=".gz") as f:
+            f.write(gzip.compress(text.encode()))
+            f.write(gzip.compress(b"appended member\n"))
+            temp_path = f.name
+
+        try:
+            result = self.run_less(temp_path)
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(result.stdout, text + "appended member\n")
+        finally:
+            os.unlink(temp_path)
+
+    def test_zstd_file(self):
+        """Test a zstd file is shown decompressed."""
+        if not shutil.which("zstd"):
+            self.skipTest("zstd not installed")
+        with tempfile.TemporaryDirectory() as tmpdir:
+            plain = Path(tmpdir, "app.log")
+            plain.write_text("".join(f"entry {i}\n" for i in range(20000)))
+            packed = Path(tmpdir, "app.log.zst")
+            subprocess.run(["zstd", "-q", str(plain), "-o", str(packed)],
+                           check=True)
+            result = self.run_less("-N", str(packed))
+            self.assertEqual(result.returncode, 0)
+            lines = result.stdout.splitlines()
+            self.assertEqual(len(lines), 20000)
+            self.assertEqual(lines[-1], " 20000  entry 19999")
+
+    def test_truncated_gzip_file(self):
+        """Test a truncated gzip file shows what it holds and an error."""
+        text = "".join(f"row {i}\n" for i in range(100000))
+        data = gzip.compress(text.encode())
+        with tempfile.NamedTemporaryFile(delete=False, suffix=".gz") as f:
+            f.write(data[:len(data) // 2])
+            temp_path = f.name
+
+        try:
+            result = self.run_less(temp_path)
+            self.assertEqual(result.returncode, 1)
+            self.assertIn("unexpected end of compressed data", result.stderr)
+            self.assertTrue(result.stdout.startswith("row 0\nrow 1\n"))
+        finally:
+            os.unlink(temp_path)
 
 if __name__ == "__main__":
     unittest.main()
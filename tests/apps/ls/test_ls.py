@@ -264,5 +264,219 @@ class TestLsCommand(unittest.TestCase):
         self.assertNotEqual(result.returncode, 0)
 
 
+    def make_sort_fixture(self, tmpdir):
+        """Create files whose name, size and mtime orders all differ."""
+        for name, size, age in (("b.txt", 30, 300), ("c.txt", 10, 100),
+                                ("a.txt", 20, 200)):
+            path = Path(tmpdir, name)
+            path.write_bytes(b"x" * size)
+            mtime = 1700000000 - age
+            os.utime(path, (mtime, mtime))
+
+    def test_sorted_by_name(self):
+        """Test entries are listed in name order by default."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            self.make_sort_fixture(tmpdir)
+            result = self.run_ls(tmpdir)
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(result.stdout.split(), ["a.txt", "b.txt", "c.txt"])
+
+    def test_sort_by_size(self):
+        """Test -S lists the largest entries first."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            self.make_sort_fixture(tmpdir)
+            result = self.run_ls("-S", tmpdir)
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(result.stdout.split(), ["b.txt", "a.txt", "c.txt"])
+
+    def test_sort_by_time(self):
+        """Test -t lists the newest entries first."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            self.make_sort_fixture(tmpdir)
+            result = self.run_ls("-t", tmpdir)
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(result.stdout.split(), ["c.txt", "a.txt", "b.txt"])
+
+    def test_sort_reverse(self):
+        """Test -r reverses the sort order."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            self.make_sort_fixture(tmpdir)
+            result = self.run_ls("-r", "--sort", "size", tmpdir)
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(result.stdout.split(), ["c.txt", "a.txt", "b.txt"])
+
+    def test_sort_json(self):
+        """Test --json output follows the sort order."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            self.make_sort_fixture(tmpdir)
+            result = self.run_ls("--json", "-t", tmpdir)
+            self.assertEqual(result.returncode, 0)
+            data = json.loads(result.stdout)
+            self.assertEqual([item["name"] for item in data],
+                             ["c.txt", "a.txt", "b.txt"])
+
+    def test_unsorted_lists_everything(self):
+        """Test -U lists every entry in directory order."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            for i in range(500):
+                Path(tmpdir, f"f{i}").touch()
+            result = self.run_ls("-U", tmpdir)
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(sorted(result.stdout.split()),
+                             sorted(f"f{i}" for i in range(500)))
+
+    def test_sort_invalid_word(self):
+        """Test an unknown --sort word is rejected."""
+        result = self.run_ls("--sort", "color", ".")
+        self.assertNotEqual(result.returncode, 0)
+        self.assertIn("--sort", result.stderr)
+
+    def test_large_directory(self):
+        """Test a directory larger than one getdents batch is listed in full."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            names = [f"entry_with_a_fairly_long_name_{i:05d}"
+                     for i in range(6000)]
+            for name in names:
+                Path(tmpdir, name).touch()
+            result = self.run_ls(tmpdir)
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(result.stdout.split(), names)
+
+    def read_pages(self, tmpdir, *args):
+        """Page through tmpdir with --limit, returning each page's names."""
+        pages = []
+        cursor = []
+        while True:
+            result = self.run_ls("--json", "--limit", "7", *args, *cursor,
+                                 tmpdir)
+            self.assertEqual(result.returncode, 0, result.stderr)
+            entries = json.loads(result.stdout)
+            cursor = []
+            if entries and "cursor" in entries[-1]:
+                cursor = ["--cursor", entries.pop()["cursor"]]
+            pages.append([e["name"] for e in entries])
+            if not cursor:
+                return pages
+
+    def test_limit_and_cursor(self):
+        """Test --limit pages resume with --cursor in every sort order."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            for i in range(30):
+                Path(tmpdir, f"f{(i * 7) % 30:02d}").write_bytes(b"x" * (i % 4))
+            for args in ([], ["-r"], ["-S"], ["-t", "-r"], ["-U"]):
+                full = [e["name"] for e in json.loads(
+                    self.run_ls("--json", *args, tmpdir).stdout)]
+                pages = self.read_pages(tmpdir, *args)
+                self.assertEqual([len(p) for p in pages], [7, 7, 7, 7, 2])
+                self.assertEqual(sum(pages, []), full)
+
+    def test_cursor_errors(self):
+        """Test cursors are refused for another order or directory."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            for name in ("a", "b", "c"):
+                Path(tmpdir, name).touch()
+            result = self.run_ls("--limit", "1", tmpdir)
+            self.assertEqual(result.stdout, "a\n")
+            cursor = result.stderr.split()[-1]
+
+            result = self.run_ls("--cursor", cursor, tmpdir)
+            self.assertEqual(result.stdout, "b\nc\n")
+            self.assertEqual(self.run_ls("--cursor", cursor, "-S",
+                                         tmpdir).returncode, 1)
+            self.assertEqual(self.run_ls("--cursor", cursor,
+                                         tempfile.gettempdir()).returncode, 1)
+            self.assertEqual(self.run_ls("--cursor", "nope",
+                                         tmpdir).returncode, 1)
+            self.assertEqual(self.run_ls("-R", "--limit", "1",
+                                         tmpdir).returncode, 1)
+
+    def make_tree(self, tmpdir):
+        """Create a small tree: top/{a/{b/{c/z}, y}, x, link -> a}."""
+        top = Path(tmpdir, "top")
+        Path(top, "a", "b", "c").mkdir(parents=True)
+        Path(top, "a", "b", "c", "z").touch()
+        Path(top, "a", "y").touch()
+        Path(top, "x").write_text("hello")
+        os.symlink("a", top / "link")
+        return top
+
+    def test_recursive(self):
+        """Test -R lists every directory under a header."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            top = self.make_tree(tmpdir)
+            result = self.run_ls("-R", str(top))
+            self.assertEqual(result.returncode, 0)
+            blocks = result.stdout.strip().split("\n\n")
+            self.assertEqual(blocks, [
+                f"{top}:\na\nlink\nx",
+                f"{top}/a:\nb\ny",
+                f"{top}/a/b:\nc",
+                f"{top}/a/b/c:\nz",
+            ])
+
+    def test_recursive_max_depth(self):
+        """Test --max-depth limits how far -R descends."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            top = self.make_tree(tmpdir)
+            result = self.run_ls("-R", "--max-depth", "1", str(top))
+            self.assertEqual(result.returncode, 0)
+            self.assertIn(f"{top}/a:", result.stdout)
+            self.assertNotIn(f"{top}/a/b:", result.stdout)
+
+            result = self.run_ls("-R", "--max-depth", "0", str(top))
+            self.assertEqual(result.returncode, 0)
+            self.assertNotIn(f"{top}/a:", result.stdout)
+
+    def test_recursive_json_tree(self):
+        """Test --json -R nests subdirectory entries under children."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            top = self.make_tree(tmpdir)
+            result = self.run_ls("--json", "-R", str(top))
+            self.assertEqual(result.returncode, 0)
+            data = json.loads(result.stdout)
+            by_name = {item["name"]: item for item in data}
+            self.assertEqual(set(by_name), {"a", "link", "x"})
+            self.assertEqual(by_name["link"]["type"], "symlink")
+            self.assertNotIn("children", by_name["link"])
+            self.assertNotIn("children", by_name["x"])
+            a_children = {c["name"]: c for c in by_name["a"]["children"]}
+            self.assertEqual(set(a_children), {"b", "y"})
+            c_dir = a_children["b"]["children"][0]
+            self.assertEqual(c_dir["name"], "c")
+            self.assertEqual([z["name"] for z in c_dir["children"]], ["z"])
+
+    def test_recursive_json_stream(self):
+        """Test --json-stream -R emits one object per line with its path."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            top = self.make_tree(tmpdir)
+            result = self.run_ls("--json-stream", "-R", str(top))
+            self.assertEqual(result.returncode, 0)
+            lines = result.stdout.splitlines()
+            objs = [json.loads(line) for line in lines]
+            paths = {o["path"]: o for o in objs}
+            self.assertEqual(set(paths), {
+                f"{top}/a", f"{top}/link", f"{top}/x", f"{top}/a/b",
+                f"{top}/a/y", f"{top}/a/b/c", f"{top}/a/b/c/z",
+            })
+            self.assertEqual(paths[f"{top}/x"]["size"], 5)
+            self.assertEqual(paths[f"{top}/a/b/c"]["type"], "directory")
+
+    def test_recursive_many_entries(self):
+        """Test -R with directories large enough to stat in parallel."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            for d in range(3):
+                sub = Path(tmpdir, f"d{d}")
+                sub.mkdir()
+                for i in range(1000):
+                    (sub / f"f{i:04d}").write_bytes(b"x" * (i % 7))
+            result = self.run_ls("--json-stream", "-R", "-S", tmpdir)
+            self.assertEqual(result.returncode, 0)
+            objs = [json.loads(line) for line in result.stdout.splitlines()]
+            self.assertEqual(len(objs), 3003)
+            sizes = [o["size"] for o in objs if o["path"].startswith(
+                str(Path(tmpdir, "d1")) + "/")]
+            self.assertEqual(len(sizes), 1000)
+            self.assertEqual(sizes, sorted(sizes, reverse=True))
+
 if __name__ == "__main__":
     unittest.main()
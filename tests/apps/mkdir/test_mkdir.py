@@ -20,11 +20,12 @@ class TestMkdirCommand(unittest.TestCase):
         if not cls.MKDIR_BIN.exists():
             raise unittest.SkipTest(f"mkdir binary not found at {cls.MKDIR_BIN}")
 
-    def run_mkdir(self, *args):
+    def run_mkdir(self, *args, input=None):
         """Run the mkdir command with given arguments and return result."""
         cmd = [str(self.MKDIR_BIN)] + list(args)
         result = subprocess.run(
             cmd,
+            input=input,
             capture_output=True,
             text=True,
             env={**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
@@ -167,6 +168,42 @@ class TestMkdirCommand(unittest.TestCase):
             self.assertEqual(result.returncode, 0)
             self.assertTrue(new_dir.exists())
 
+    def test_parents_deep_path(self):
+        """Test -p creates a path deeper than the directory cache."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            deep = Path(tmpdir, *[f"d{i}" for i in range(300)])
+
+            result = self.run_mkdir("-p", os.path.relpath(deep))
+            self.assertEqual(result.returncode, 0, result.stderr)
+            self.assertTrue(deep.is_dir())
+
+    def test_stdin0_batch(self):
+        """Test --stdin0 creates many directories sharing parents."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            paths = [str(Path(tmpdir, f"a{i % 400}", f"b{i}"))
+                     for i in range(2000)]
+
+            result = self.run_mkdir("-p", "--stdin0",
+                                    input="\0".join(paths) + "\0")
+            self.assertEqual(result.returncode, 0, result.stderr)
+            for path in paths:
+                self.assertTrue(Path(path).is_dir(), path)
+
+    def test_stdin0_without_parents(self):
+        """Test --stdin0 without -p reports missing parents."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            good = Path(tmpdir, "good")
+            bad = Path(tmpdir, "missing", "bad")
+
+            result = self.run_mkdir("--stdin0", "--json",
+                                    input=f"{good}\0{bad}")
+            self.assertNotEqual(result.returncode, 0)
+            entries = json.loads(result.stdout)
+            self.assertEqual(len(entries), 2)
+            self.assertEqual(entries[0]["status"], "ok")
+            self.assertNotEqual(entries[1]["status"], "ok")
+            self.assertTrue(good.is_dir())
+
 
 if __name__ == "__main__":
     unittest.main()
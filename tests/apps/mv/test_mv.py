@@ -3,6 +3,7 @@
 
 import json
 import os
+import stat
 import subprocess
 import tempfile
 import unittest
@@ -257,5 +258,76 @@ class TestMvCommand(unittest.TestCase):
             self.assertEqual(dest.read_bytes(), binary_content)
 
 
+    def cross_device_dirs(self):
+        """Return a pair of temp dirs on different filesystems, or skip."""
+        if not os.path.isdir("/dev/shm"):
+            self.skipTest("/dev/shm not available")
+        src_root = tempfile.TemporaryDirectory(dir="/dev/shm")
+        dest_root = tempfile.TemporaryDirectory()
+        self.addCleanup(src_root.cleanup)
+        self.addCleanup(dest_root.cleanup)
+        if os.stat(src_root.name).st_dev == os.stat(dest_root.name).st_dev:
+            self.skipTest("no second filesystem to move across")
+        return Path(src_root.name), Path(dest_root.name)
+
+    def test_move_file_across_devices(self):
+        """Test that a file moved to another filesystem is copied and removed."""
+        src_root, dest_root = self.cross_device_dirs()
+        src = src_root / "data.bin"
+        dest = dest_root / "data.bin"
+        content = os.urandom(3 * 1024 * 1024)
+        src.write_bytes(content)
+        os.chmod(src, 0o640)
+
+        result = self.run_mv(str(src), str(dest))
+        self.assertEqual(result.returncode, 0, result.stderr)
+        self.assertFalse(src.exists())
+        self.assertEqual(dest.read_bytes(), content)
+        self.assertEqual(os.stat(dest).st_mode & 0o777, 0o640)
+        self.assertEqual(os.listdir(dest_root), ["data.bin"])
+
+    def test_move_tree_across_devices(self):
+        """Test that a directory tree moves across filesystems intact."""
+        src_root, dest_root = self.cross_device_dirs()
+        tree = src_root / "tree"
+        for i in range(20):
+            sub = tree / f"d{i}" / "nested"
+            sub.mkdir(parents=True)
+            for j in range(10):
+                (sub / f"f{j}.txt").write_text(f"{i}-{j}\n")
+        os.symlink("d0/nested/f0.txt", tree / "link")
+        os.mkfifo(tree / "fifo")
+
+        result = self.run_mv(str(tree), str(dest_root))
+        self.assertEqual(result.returncode, 0, result.stderr)
+        self.assertFalse(tree.exists())
+        moved = dest_root / "tree"
+        self.assertEqual(os.listdir(dest_root), ["tree"])
+        self.assertEqual(
+            (moved / "d7" / "nested" / "f3.txt").read_text(), "7-3\n")
+        self.assertEqual(os.readlink(moved / "link"), "d0/nested/f0.txt")
+        self.assertTrue(stat.S_ISFIFO(os.lstat(moved / "fifo").st_mode))
+        count = sum(len(files) for _, _, files in os.walk(moved))
+        self.assertEqual(count, 202)
+
+    def test_move_across_devices_without_force(self):
+        """Test that a cross-device move does not replace an existing file."""
+        src_root, dest_root = self.cross_device_dirs()
+        src = src_root / "a.txt"
+        dest = dest_root / "a.txt"
+        src.write_text("new")
+        dest.write_text("old")
+
+        result = self.run_mv(str(src), str(dest))
+        self.assertNotEqual(result.returncode, 0)
+        self.assertEqual(dest.read_text(), "old")
+        self.assertTrue(src.exists())
+        self.assertEqual(os.listdir(dest_root), ["a.txt"])
+
+        result = self.run_mv("-f", str(src), str(dest))
+        self.assertEqual(result.returncode, 0, result.stderr)
+        self.assertEqual(dest.read_text(), "new")
+        self.assertFalse(src.exists())
+
 if __name__ == "__main__":
     unittest.main()
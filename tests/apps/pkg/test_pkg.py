@@ -1,10 +1,12 @@
 #!/usr/bin/env python3
 """Unit tests for the pkg command."""
 
+import hashlib
 import json
 import os
 import shutil
 import subprocess
+import tarfile
 import tempfile
 import unittest
 from pathlib import Path
@@ -185,6 +187,64 @@ class TestPkgCommand(unittest.TestCase):
         finally:
             shutil.rmtree(pkg_dir.parent)
 
+    def test_build_records_hashes(self):
+        """Test build records a SHA-256 digest of each file in pkg.json."""
+        pkg_dir = self.create_test_package()
+        try:
+            with tempfile.NamedTemporaryFile(suffix=".tar.gz", delete=False) as f:
+                output_path = f.name
+
+            try:
+                result = self.run_pkg("build", str(pkg_dir), output_path)
+                self.assertEqual(result.returncode, 0)
+                with tarfile.open(output_path, "r:gz") as tar:
+                    names = tar.getnames()
+                    manifest = json.load(tar.extractfile("pkg.json"))
+                self.assertIn("bin/hello", names)
+                self.assertEqual(manifest["hashes"], {
+                    "bin/hello": hashlib.sha256(
+                        (pkg_dir / "bin" / "hello").read_bytes()).hexdigest()
+                })
+            finally:
+                Path(output_path).unlink(missing_ok=True)
+        finally:
+            shutil.rmtree(pkg_dir.parent)
+
+    # Delta tests
+    def test_delta_requires_args(self):
+        """Test delta requires two tarballs and an output path."""
+        result = self.run_pkg("delta", "old.tar.gz", "new.tar.gz")
+        self.assertNotEqual(result.returncode, 0)
+        self.assertIn("output path required", result.stderr)
+
+    def test_delta_smaller_than_tarball(self):
+        """Test delta between two versions carries only what changed."""
+        old_dir = self.create_test_package(version="1.0.0")
+        new_dir = self.create_test_package(version="1.1.0")
+        lines = [f"line {i} {hashlib.sha256(str(i).encode()).hexdigest()}\n"
+                 for i in range(5000)]
+        (old_dir / "data.txt").write_text("".join(lines))
+        lines[2500] = "changed\n"
+        (new_dir / "data.txt").write_text("".join(lines))
+        work = Path(tempfile.mkdtemp())
+        try:
+            old_tar, new_tar = work / "old.tar.gz", work / "new.tar.gz"
+            delta = work / "test-pkg.delta"
+            self.assertEqual(self.run_pkg("build", str(old_dir), str(old_tar)).returncode, 0)
+            self.assertEqual(self.run_pkg("build", str(new_dir), str(new_tar)).returncode, 0)
+
+            result = self.run_pkg("delta", str(old_tar), str(new_tar), str(delta), "--json")
+            self.assertEqual(result.returncode, 0)
+            output = json.loads(result.stdout)
+            self.assertEqual(output["status"], "ok")
+            self.assertEqual(output["size"], delta.stat().st_size)
+            self.assertEqual(delta.read_bytes()[:8], b"JPKGDLT1")
+            self.assertLess(delta.stat().st_size, new_tar.stat().st_size // 10)
+        finally:
+            shutil.rmtree(work)
+            shutil.rmtree(old_dir.parent)
+            shutil.rmtree(new_dir.parent)
+
     # Install tests
     def test_install_requires_tarball(self):
         """Test install requires tarball path."""
@@ -248,6 +308,59 @@ class TestPkgCommand(unittest.TestCase):
         finally:
             shutil.rmtree(pkg_dir.parent)
 
+    def test_install_rejects_modified_file(self):
+        """Test install fails when a file does not match its digest."""
+        pkg_dir = self.create_test_package()
+        try:
+            with tempfile.NamedTemporaryFile(suffix=".tar.gz", delete=False) as f:
+                tarball_path = f.name
+
+            try:
+                self.run_pkg("build", str(pkg_dir), tarball_path)
+                extract_dir = pkg_dir.parent / "extracted"
+                with tarfile.open(tarball_path, "r:gz") as tar:
+                    tar.extractall(extract_dir)
+                with open(extract_dir / "bin" / "hello", "a") as f:
+                    f.write("echo tampered\n")
+                with tarfile.open(tarball_path, "w:gz") as tar:
+                    tar.add(extract_dir, arcname=".")
+
+                result = self.run_pkg("install", tarball_path, "--json")
+                self.assertNotEqual(result.returncode, 0)
+                output = json.loads(result.stdout)
+                self.assertEqual(output["status"], "error")
+                self.assertEqual(output["file"], "bin/hello")
+                self.assertFalse(
+                    (self.JSHELL_HOME / "pkgs" / "test-pkg-1.0.0").exists())
+            finally:
+                Path(tarball_path).unlink(missing_ok=True)
+        finally:
+            shutil.rmtree(pkg_dir.parent)
+
+    def test_install_rejects_other_platform(self):
+        """Test a prebuilt package for another platform is not installed."""
+        pkg_dir = self.create_test_package()
+        manifest = json.loads((pkg_dir / "pkg.json").read_text())
+        manifest["platform"] = "plan9-mips"
+        (pkg_dir / "pkg.json").write_text(json.dumps(manifest, indent=2))
+        try:
+            with tempfile.NamedTemporaryFile(suffix=".tar.gz", delete=False) as f:
+                tarball_path = f.name
+
+            try:
+                self.run_pkg("build", str(pkg_dir), tarball_path)
+                result = self.run_pkg("install", tarball_path, "--json")
+                self.assertNotEqual(result.returncode, 0)
+                output = json.loads(result.stdout)
+                self.assertEqual(output["status"], "error")
+                self.assertEqual(output["platform"], "plan9-mips")
+                self.assertFalse(
+                    (self.JSHELL_HOME / "pkgs" / "test-pkg-1.0.0").exists())
+            finally:
+                Path(tarball_path).unlink(missing_ok=True)
+        finally:
+            shutil.rmtree(pkg_dir.parent)
+
     def test_install_already_installed(self):
         """Test installing package that's already installed."""
         pkg_dir = self.create_test_package()
@@ -479,6 +592,13 @@ class TestPkgCommand(unittest.TestCase):
         result = self.run_pkg("unknown")
         self.assertNotEqual(result.returncode, 0)
 
+    def test_segments_out_of_range(self):
+        """Test --segments outside 1..64 is refused."""
+        for value in ("0", "65"):
+            result = self.run_pkg("--segments", value, "install", "ls")
+            self.assertNotEqual(result.returncode, 0)
+            self.assertIn("--segments", result.stderr)
+
 
 class TestPkgRegistry(unittest.TestCase):
     """Test cases for pkg registry commands (require registry server)."""
@@ -599,6 +719,20 @@ class TestPkgRegistry(unittest.TestCase):
         self.assertIn("results", output)
         self.assertTrue(any(r["name"] == "cat" for r in output["results"]))
 
+    def test_search_exact_name_first(self):
+        """Test search lists an exact name match before other matches."""
+        result = self.run_pkg("search", "ls", "--json")
+        self.assertEqual(result.returncode, 0)
+        output = json.loads(result.stdout)
+        self.assertEqual(output["results"][0]["name"], "ls")
+
+    def test_search_case_insensitive(self):
+        """Test search ignores case."""
+        result = self.run_pkg("search", "CAT", "--json")
+        self.assertEqual(result.returncode, 0)
+        output = json.loads(result.stdout)
+        self.assertTrue(any(r["name"] == "cat" for r in output["results"]))
+
     def test_search_no_results(self):
         """Test search with no matches."""
         result = self.run_pkg("search", "nonexistent-package-xyz")
@@ -1,8 +1,10 @@
 #!/usr/bin/env python3
 """Unit tests for the rg command."""
 
+import gzip
 import json
 import os
+import shutil
 import subprocess
 import tempfile
 import unittest
@@ -391,5 +393,363 @@ class TestRgCommand(unittest.TestCase):
             os.unlink(temp_path)
 
 
+    def test_stdin_context(self):
+        """Test context lines and separators when reading stdin."""
+        result = self.run_rg("-n", "-C", "1", "match",
+                             input_data="a\nmatch1\nb\nc\nd\nmatch2\ne\n")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout,
+                         "1-a\n2:match1\n3-b\n--\n5-d\n6:match2\n7-e\n")
+
+    def test_line_longer_than_read_chunk(self):
+        """Test that lines spanning several reads are matched whole."""
+        with tempfile.NamedTemporaryFile(mode="w", delete=False, suffix=".txt") as f:
+            f.write("x" * 200000 + "needle\nother\n")
+            temp_path = f.name
+
+        try:
+            result = self.run_rg("-n", "needle", temp_path)
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(result.stdout, "1:" + "x" * 200000 + "needle\n")
+        finally:
+            os.unlink(temp_path)
+
+    def test_recursive_directory(self):
+        """Test searching a directory recursively in sorted order."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            Path(tmpdir, "b", "c").mkdir(parents=True)
+            Path(tmpdir, "z.txt").write_text("needle z\n")
+            Path(tmpdir, "a.txt").write_text("needle a\nother\n")
+            Path(tmpdir, "b", "c", "deep.txt").write_text("needle deep\n")
+
+            result = self.run_rg("needle", tmpdir)
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(result.stdout.splitlines(), [
+                f"{tmpdir}/a.txt:needle a",
+                f"{tmpdir}/b/c/deep.txt:needle deep",
+                f"{tmpdir}/z.txt:needle z",
+            ])
+
+    def test_recursive_honors_gitignore(self):
+        """Test that .gitignore, .git and binary files are skipped."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            Path(tmpdir, ".git").mkdir()
+            Path(tmpdir, "build").mkdir()
+            Path(tmpdir, ".gitignore").write_text("build/\n*.log\n!keep.log\n")
+            Path(tmpdir, ".git", "HEAD").write_text("needle\n")
+            Path(tmpdir, "build", "out.txt").write_text("needle\n")
+            Path(tmpdir, "drop.log").write_text("needle\n")
+            Path(tmpdir, "keep.log").write_text("needle\n")
+            Path(tmpdir, "data.bin").write_bytes(b"needle\0\n")
+            Path(tmpdir, "src.c").write_text("needle\n")
+
+            result = self.run_rg("needle", tmpdir)
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(result.stdout.splitlines(), [
+                f"{tmpdir}/keep.log:needle",
+                f"{tmpdir}/src.c:needle",
+            ])
+
+    def test_recursive_json(self):
+        """Test JSON output across many files stays valid and ordered."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            for i in range(50):
+                Path(tmpdir, f"f{i:02d}.txt").write_text(f"x\nhit {i}\n")
+
+            result = self.run_rg("--json", "hit", tmpdir)
+            self.assertEqual(result.returncode, 0)
+            data = json.loads(result.stdout)
+            self.assertEqual([d["text"] for d in data],
+                             [f"hit {i}" for i in range(50)])
+            self.assertEqual(data[0]["line"], 2)
+
+    def test_fixed_strings_ignore_case_word(self):
+        """Test literal search combined with -i and -w."""
+        result = self.run_rg("-n", "-i", "-w", "--fixed-strings", "foo.bar",
+                             input_data="FOO.BAR\nxfoo.bar\nfoo.barx\n(Foo.Bar)\n")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, "1:FOO.BAR\n4:(Foo.Bar)\n")
+
+    def test_literal_prefix_regex(self):
+        """Test a regex with a literal prefix reports its first match."""
+        result = self.run_rg("--json", "foo+ba[rz]",
+                             input_data="fo bar\nxx foobaz foooobar\nfoobaq\n")
+        self.assertEqual(result.returncode, 0)
+        data = json.loads(result.stdout)
+        self.assertEqual([(d["line"], d["column"]) for d in data], [(2, 4)])
+
+    def test_regex_leftmost_longest_column(self):
+        """Test the column of the leftmost match with alternation."""
+        result = self.run_rg("--json", "-i", "b+c|ab",
+                             input_data="xAbbc\nzzz\n  bBC ab\n")
+        self.assertEqual(result.returncode, 0)
+        data = json.loads(result.stdout)
+        self.assertEqual([(d["line"], d["column"]) for d in data],
+                         [(1, 2), (3, 3)])
+
+    def test_regex_anchors_and_word_boundaries(self):
+        """Test ^, $ and -w against whole lines."""
+        result = self.run_rg("-n", "-w", "^(get|set)_[a-z]+$",
+                             input_data="get_x\nset_value\nreset_x\nget_x1\n")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, "1:get_x\n2:set_value\n")
+
+    def test_regex_backreference(self):
+        """Test patterns only the POSIX engine handles still match."""
+        result = self.run_rg("--json", "([a-z])\\1",
+                             input_data="abc\nabbc\n")
+        self.assertEqual(result.returncode, 0)
+        data = json.loads(result.stdout)
+        self.assertEqual([(d["line"], d["column"]) for d in data], [(2, 2)])
+
+    def test_only_matching(self):
+        """Test -o prints each match with its own column."""
+        result = self.run_rg("--json", "-o", "fo+",
+                             input_data="foo bar fooo\nbar\nxfo\n")
+        self.assertEqual(result.returncode, 0)
+        data = json.loads(result.stdout)
+        self.assertEqual([(d["line"], d["column"], d["text"]) for d in data],
+                         [(1, 1, "foo"), (1, 9, "fooo"), (3, 2, "fo")])
+
+    def test_only_matching_anchor(self):
+        """Test later matches in a line do not satisfy ^."""
+        result = self.run_rg("-o", "^ab", input_data="abab\n")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, "ab\n")
+
+    def test_count(self):
+        """Test -c counts matching lines per file."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            Path(tmpdir, "a.txt").write_text("foo foo\nbar\nfoo\n")
+            Path(tmpdir, "b.txt").write_text("bar\n")
+            result = self.run_rg("-c", "foo", tmpdir)
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(result.stdout, f"{tmpdir}/a.txt:2\n")
+
+    def test_files_with_matches(self):
+        """Test -l lists each matching file once."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            Path(tmpdir, "a.txt").write_text("foo\n" * 1000)
+            Path(tmpdir, "b.txt").write_text("bar\n")
+            Path(tmpdir, "c.txt").write_text("bar\nfoo\n")
+            result = self.run_rg("-l", "foo", tmpdir)
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(result.stdout,
+                             f"{tmpdir}/a.txt\n{tmpdir}/c.txt\n")
+
+    def test_max_results(self):
+        """Test --max-results keeps the first matching lines in path order."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            for name in ("a", "b", "c", "d"):
+                Path(tmpdir, f"{name}.txt").write_text(
+                    "".join(f"hit {i}\n" for i in range(3)))
+            full = self.run_rg("-n", "hit", tmpdir).stdout.splitlines()
+            for n in (1, 3, 5, 12, 20):
+                result = self.run_rg("-n", "--max-results", str(n), "hit",
+                                     tmpdir)
+                self.assertEqual(result.returncode, 0)
+                self.assertEqual(result.stdout.splitlines(), full[:n])
+
+            result = self.run_rg("-c", "--max-results", "4", "hit", tmpdir)
+            self.assertEqual(result.stdout,
+                             f"{tmpdir}/a.txt:3\n{tmpdir}/b.txt:1\n")
+            result = self.run_rg("-l", "--max-results", "2", "hit", tmpdir)
+            self.assertEqual(result.stdout,
+                             f"{tmpdir}/a.txt\n{tmpdir}/b.txt\n")
+
+            result = self.run_rg("--max-results", "0", "hit", tmpdir)
+            self.assertEqual(result.returncode, 1)
+            self.assertIn("--max-results", result.stderr)
+
+    def test_max_filesize(self):
+        """Test --max-filesize skips larger files."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            Path(tmpdir, "small.txt").write_text("hit\n")
+            Path(tmpdir, "big.txt").write_text("hit\n" * 1000)
+            result = self.run_rg("-l", "--max-filesize", "1K", "hit", tmpdir)
+            self.assertEqual(result.stdout, f"{tmpdir}/small.txt\n")
+            result = self.run_rg("-l", "--max-filesize", "4000", "hit",
+                                 tmpdir)
+            self.assertEqual(result.stdout,
+                             f"{tmpdir}/big.txt\n{tmpdir}/small.txt\n")
+
+            result = self.run_rg("--max-filesize", "1X", "hit", tmpdir)
+            self.assertEqual(result.returncode, 1)
+            self.assertIn("--max-filesize", result.stderr)
+
+    def test_json_stream(self):
+        """Test --json-stream writes one JSON object per line."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            Path(tmpdir, "a.txt").write_text('say "hi"\nbye\n')
+            Path(tmpdir, "b.txt").write_text("hi\n")
+            result = self.run_rg("--json-stream", "hi", tmpdir)
+            self.assertEqual(result.returncode, 0)
+            records = [json.loads(line) for line in result.stdout.splitlines()]
+            self.assertEqual([(r["file"], r["text"]) for r in records],
+                             [(f"{tmpdir}/a.txt", 'say "hi"'),
+                              (f"{tmpdir}/b.txt", "hi")])
+
+    def test_json_stream_incremental(self):
+        """Test records from a pipe arrive before the input ends."""
+        proc = subprocess.Popen(
+            [str(self.RG_BIN), "--json-stream", "hit"],
+            stdin=subprocess.PIPE, stdout=subprocess.PIPE, text=True,
+            env={**os.environ, "ASAN_OPTIONS": "detect_leaks=0"})
+        try:
+            proc.stdin.write("miss\nhit one\n")
+            proc.stdin.flush()
+            record = json.loads(proc.stdout.readline())
+            self.assertEqual((record["line"], record["text"]), (2, "hit one"))
+        finally:
+            proc.stdin.close()
+            proc.stdout.close()
+            proc.wait()
+
+    def test_search_zip(self):
+        """Test -z searches gzip and zstd files as text."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            text = "ok\n" * 50000 + "disk ERROR\n"
+            Path(tmpdir, "a.log.gz").write_bytes(gzip.compress(text.encode()))
+            # Concatenated members, as pigz and compress write
+            Path(tmpdir, "b.gz").write_bytes(gzip.compress(b"one\n")
+                                             + gzip.compress(b"ERROR two\n"))
+            Path(tmpdir, "c.log").write_text("ERROR plain\n")
+            result = self.run_rg("-z", "-n", "ERROR", tmpdir)
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(result.stdout,
+                             f"{tmpdir}/a.log.gz:50001:disk ERROR\n"
+                             f"{tmpdir}/b.gz:2:ERROR two\n"
+                             f"{tmpdir}/c.log:1:ERROR plain\n")
+
+            # Without -z compressed files are binary and skipped
+            result = self.run_rg("-l", "ERROR", tmpdir)
+            self.assertEqual(result.stdout, f"{tmpdir}/c.log\n")
+
+            if shutil.which("zstd"):
+                subprocess.run(["zstd", "-q", str(Path(tmpdir, "c.log")),
+                                "-o", str(Path(tmpdir, "d.zst"))], check=True)
+                result = self.run_rg("-z", "plain", str(Path(tmpdir, "d.zst")))
+                self.assertEqual(result.stdout, "ERROR plain\n")
+
+    def test_search_zip_stdin(self):
+        """Test -z decompresses standard input."""
+        result = subprocess.run(
+            [str(self.RG_BIN), "-z", "-c", "hit"],
+            input=gzip.compress(b"hit\nmiss\nhit\n"), capture_output=True,
+            env={**os.environ, "ASAN_OPTIONS": "detect_leaks=0"})
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, b"2\n")
+
+    def test_search_zip_truncated(self):
+        """Test -z reports a compressed file cut short."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            data = gzip.compress(os.urandom(100000))
+            path = Path(tmpdir, "cut.gz")
+            path.write_bytes(data[:len(data) // 2])
+            result = self.run_rg("-z", "--json", "never", str(path))
+            self.assertEqual(result.returncode, 1)
+            self.assertIn("error", json.loads(result.stdout)[0])
+
+    def test_multiple_patterns(self):
+        """Test -e searches for several patterns in one pass."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = Path(tmpdir, "m.txt")
+            path.write_text("foo bar\nbaz qux\nnothing\nFOOBAR\n")
+
+            result = self.run_rg("-n", "-e", "foo", "-e", "qux", str(path))
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(result.stdout, "1:foo bar\n2:baz qux\n")
+
+            result = self.run_rg("-i", "-o", "-e", "foo", "-e", "foobar",
+                                 "-e", "ba", str(path))
+            self.assertEqual(result.stdout, "foo\nba\nba\nFOOBAR\n")
+
+            # Literal sets and regex sets both say which pattern matched
+            for patterns in (["bar", "qux"], ["ba[rz]", "q.x"]):
+                args = [arg for p in patterns for arg in ("-e", p)]
+                result = self.run_rg("--json", "-o", *args, str(path))
+                entries = json.loads(result.stdout)
+                self.assertEqual([(e["text"], e["pattern"]) for e in entries],
+                                 [("bar", patterns[0]), ("baz", patterns[0]),
+                                  ("qux", patterns[1])]
+                                 if patterns[0] == "ba[rz]" else
+                                 [("bar", "bar"), ("qux", "qux")])
+
+            # A pattern with a backreference is matched on its own
+            result = self.run_rg("-c", "-e", "(o)\\1", "-e", "qux", str(path))
+            self.assertEqual(result.stdout, "2\n")
+
+    def test_pattern_file(self):
+        """Test -f reads one pattern per line, and PATTERN becomes a FILE."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = Path(tmpdir, "m.txt")
+            path.write_text("alpha\nbeta\ngamma\n")
+            patterns = Path(tmpdir, "patterns")
+            patterns.write_text("gamma\nalpha\n")
+
+            result = self.run_rg("-f", str(patterns), str(path))
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(result.stdout, "alpha\ngamma\n")
+
+            result = self.run_rg("-f", str(patterns), "-e", "beta", "-c",
+                                 str(path), str(path))
+            self.assertEqual(result.stdout, f"{path}:3\n{path}:3\n")
+
+            patterns.write_text("")
+            result = self.run_rg("-f", str(patterns), str(path))
+            self.assertEqual((result.returncode, result.stdout), (1, ""))
+
+            result = self.run_rg("-f", str(Path(tmpdir, "missing")),
+                                 str(path))
+            self.assertEqual(result.returncode, 1)
+            self.assertIn("missing", result.stderr)
+
+    def test_index_build_and_search(self):
+        """Test --indexed finds what a full search does, after updates."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            home = Path(tmpdir, "home")
+            home.mkdir()
+            tree = Path(tmpdir, "tree")
+            Path(tree, "sub").mkdir(parents=True)
+            Path(tree, "a.c").write_text("int parse_config(void);\n")
+            Path(tree, "b.c").write_text("int main(void);\n")
+            Path(tree, "sub", "c.c").write_text("PARSE_CONFIG\nparse\n_config\n")
+            env = {**os.environ, "HOME": str(home),
+                   "ASAN_OPTIONS": "detect_leaks=0"}
+
+            def rg(*args):
+                return subprocess.run([str(self.RG_BIN), *args],
+                                      capture_output=True, text=True, env=env)
+
+            result = rg("--index", "build", str(tree))
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(result.stdout,
+                             f"{tree}: indexed 3 files (3 read), "
+                             f"{len(self.trigrams(tree))} trigrams\n")
+
+            Path(tree, "b.c").write_text("int parse_config(int);\n")
+            result = rg("--json", "--index", "build", str(tree))
+            stats = json.loads(result.stdout)[0]
+            self.assertEqual((stats["files"], stats["read"]), (3, 1))
+
+            for args in [("parse_config",), ("-i", "parse_config"),
+                         ("-w", "main"), ("-i", "x")]:
+                full = rg("-l", *args, str(tree))
+                indexed = rg("-l", "--indexed", *args, str(tree))
+                self.assertEqual(indexed.stdout, full.stdout, args)
+            result = rg("-l", "--indexed", "-i", "parse_config",
+                        str(tree / "sub"))
+            self.assertEqual(result.stdout, f"{tree}/sub/c.c\n")
+
+    @staticmethod
+    def trigrams(tree):
+        """Distinct case-folded trigrams of the files under tree."""
+        found = set()
+        for path in tree.rglob("*"):
+            if path.is_file():
+                for line in path.read_bytes().lower().split(b"\n"):
+                    found.update(line[i:i + 3] for i in range(len(line) - 2))
+        return found
+
 if __name__ == "__main__":
     unittest.main()
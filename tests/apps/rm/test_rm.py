@@ -255,5 +255,79 @@ class TestRmCommand(unittest.TestCase):
             self.assertTrue(parent.exists())
 
 
+    def test_remove_large_tree(self):
+        """Test that -r removes a wide, deep tree completely."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            tree = Path(tmpdir, "tree")
+            for i in range(40):
+                deep = tree / f"d{i}" / "a" / "b" / "c"
+                deep.mkdir(parents=True)
+                for j in range(25):
+                    (deep / f"f{j}").write_text("x")
+                    (tree / f"d{i}" / f"g{j}").write_text("y")
+
+            result = self.run_rm("-r", str(tree))
+            self.assertEqual(result.returncode, 0, result.stderr)
+            self.assertFalse(tree.exists())
+            self.assertEqual(os.listdir(tmpdir), [])
+
+    def test_recursive_does_not_follow_symlinks(self):
+        """Test that symlinks inside a tree are removed, not followed."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            outside = Path(tmpdir, "outside")
+            outside.mkdir()
+            (outside / "keep.txt").write_text("keep")
+            tree = Path(tmpdir, "tree")
+            tree.mkdir()
+            os.symlink(outside, tree / "link")
+            os.symlink("missing", tree / "dangling")
+
+            result = self.run_rm("-r", str(tree))
+            self.assertEqual(result.returncode, 0, result.stderr)
+            self.assertFalse(tree.exists())
+            self.assertEqual((outside / "keep.txt").read_text(), "keep")
+
+    def test_remove_symlink_to_directory(self):
+        """Test that a symlink argument is unlinked, not its target."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            target = Path(tmpdir, "target")
+            target.mkdir()
+            (target / "file.txt").write_text("content")
+            link = Path(tmpdir, "link")
+            os.symlink(target, link)
+
+            result = self.run_rm("-r", str(link))
+            self.assertEqual(result.returncode, 0, result.stderr)
+            self.assertFalse(os.path.lexists(link))
+            self.assertTrue((target / "file.txt").exists())
+
+    def test_async_removes_tree(self):
+        """Test --async takes targets away at once and deletes them later."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            tree = Path(tmpdir, "tree")
+            for i in range(5):
+                sub = tree / f"d{i}"
+                sub.mkdir(parents=True)
+                for j in range(20):
+                    (sub / f"f{j}").write_text("x")
+            single = Path(tmpdir, "single.txt")
+            single.write_text("content")
+
+            result = self.run_rm("--async", "-r", str(tree), str(single))
+            self.assertEqual(result.returncode, 0, result.stderr)
+            self.assertFalse(tree.exists())
+            self.assertFalse(single.exists())
+
+    def test_async_directory_needs_recursive(self):
+        """Test --async still refuses a directory without -r."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            tree = Path(tmpdir, "tree")
+            tree.mkdir()
+
+            result = self.run_rm("--async", str(tree))
+            self.assertNotEqual(result.returncode, 0)
+            self.assertIn("Is a directory", result.stderr)
+            self.assertTrue(tree.exists())
+
 if __name__ == "__main__":
     unittest.main()
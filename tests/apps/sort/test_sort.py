@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+"""Unit tests for the sort command."""
+
+import os
+import random
+import subprocess
+import tempfile
+import unittest
+from pathlib import Path
+
+
+class TestSortCommand(unittest.TestCase):
+    """Test cases for the sort command."""
+
+    SORT_BIN = Path(__file__).parent.parent.parent.parent / "bin" / "standalone-apps" / "sort"
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the sort binary exists before running tests."""
+        if not cls.SORT_BIN.exists():
+            raise unittest.SkipTest(f"sort binary not found at {cls.SORT_BIN}")
+
+    def setUp(self):
+        self.tmpdir = tempfile.TemporaryDirectory()
+        self.root = self.tmpdir.name
+
+    def tearDown(self):
+        self.tmpdir.cleanup()
+
+    def run_sort(self, *args, input=None):
+        """Run the sort command with given arguments and return result."""
+        cmd = [str(self.SORT_BIN)] + list(args)
+        result = subprocess.run(
+            cmd,
+            input=input,
+            capture_output=True,
+            text=True,
+            cwd=self.root,
+            env={**os.environ, "ASAN_OPTIONS": "detect_leaks=0",
+                 "TMPDIR": self.root}
+        )
+        return result
+
+    def sorted_lines(self, *args, lines):
+        """Sort lines and return the output lines."""
+        result = self.run_sort(*args, input="".join(l + "\n" for l in lines))
+        self.assertEqual(result.returncode, 0, result.stderr)
+        return result.stdout.splitlines()
+
+    def test_help(self):
+        """Test --help shows usage."""
+        result = self.run_sort("--help")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("Usage: sort", result.stdout)
+
+    def test_bytes(self):
+        """Test lines order by bytes, uppercase first."""
+        self.assertEqual(self.sorted_lines(lines=["b", "a", "B", "ab", ""]),
+                         ["", "B", "a", "ab", "b"])
+
+    def test_reverse(self):
+        """Test -r reverses the order."""
+        self.assertEqual(self.sorted_lines("-r", lines=["b", "c", "a"]),
+                         ["c", "b", "a"])
+
+    def test_numeric(self):
+        """Test -n compares numbers, exactly at any length."""
+        lines = ["10", "9", "-3", "0.5", "x", "-0.25", "100000000000000000001",
+                 "100000000000000000000"]
+        self.assertEqual(self.sorted_lines("-n", lines=lines),
+                         ["-3", "-0.25", "x", "0.5", "9", "10",
+                          "100000000000000000000", "100000000000000000001"])
+
+    def test_unique(self):
+        """Test -u keeps the first of equal lines."""
+        self.assertEqual(self.sorted_lines("-u", lines=["b", "a", "b", "a"]),
+                         ["a", "b"])
+        self.assertEqual(self.sorted_lines("-n", "-u",
+                                           lines=["1 x", "01 y", "2"]),
+                         ["1 x", "2"])
+
+    def test_keys(self):
+        """Test -k sorts by fields, breaking ties by the whole line."""
+        lines = ["b 2", "a 10", "c 2", "d 1"]
+        self.assertEqual(self.sorted_lines("-k", "2n", lines=lines),
+                         ["d 1", "b 2", "c 2", "a 10"])
+        self.assertEqual(self.sorted_lines("-k", "2,2nr", "-k", "1,1r",
+                                           lines=lines),
+                         ["a 10", "c 2", "b 2", "d 1"])
+
+    def test_separator(self):
+        """Test -t splits fields on a character."""
+        lines = ["x,3,a", "y,1,b", "z,2,c"]
+        self.assertEqual(self.sorted_lines("-t", ",", "-k", "2,2",
+                                           lines=lines),
+                         ["y,1,b", "z,2,c", "x,3,a"])
+
+    def test_files_and_unterminated_line(self):
+        """Test several files are sorted together, last lines ended."""
+        Path(self.root, "a").write_text("c\na")
+        Path(self.root, "b").write_text("b\n")
+        result = self.run_sort("a", "b")
+        self.assertEqual(result.stdout, "a\nb\nc\n")
+
+    def test_spill_to_disk(self):
+        """Test input larger than the buffer is merged from runs."""
+        rng = random.Random(1)
+        lines = [f"{rng.randrange(10**6)} {rng.randrange(100)}"
+                 for _ in range(50000)]
+        out = self.sorted_lines("-S", "64K", "-n", lines=lines)
+        self.assertEqual(out, sorted(lines, key=lambda l: (int(l.split()[0]), l)))
+        out = self.sorted_lines("-S", "64K", "-u", "-k", "2,2n", lines=lines)
+        self.assertEqual(len(out), len({l.split()[1] for l in lines}))
+        self.assertEqual(os.listdir(self.root), [])
+
+    def test_parallel(self):
+        """Test a large input sorted on several threads."""
+        rng = random.Random(2)
+        lines = ["".join(rng.choice("abcde") for _ in range(rng.randrange(12)))
+                 for _ in range(100000)]
+        out = self.sorted_lines("--parallel", "4", lines=lines)
+        self.assertEqual(out, sorted(lines))
+        out = self.sorted_lines("--parallel", "4", "-r", "-S", "256K",
+                                lines=lines)
+        self.assertEqual(out, sorted(lines, reverse=True))
+
+    def test_missing_file(self):
+        """Test a missing file is an error with no output."""
+        result = self.run_sort("nosuch")
+        self.assertEqual(result.returncode, 1)
+        self.assertIn("nosuch", result.stderr)
+        self.assertEqual(result.stdout, "")
+
+    def test_invalid_arguments(self):
+        """Test bad keys and buffer sizes are rejected."""
+        self.assertEqual(self.run_sort("-k", "0", input="").returncode, 1)
+        self.assertEqual(self.run_sort("-k", "1x", input="").returncode, 1)
+        self.assertEqual(self.run_sort("-S", "5Q", input="").returncode, 1)
+        self.assertEqual(self.run_sort("-t", "ab", input="").returncode, 1)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -20,13 +20,14 @@ class TestStatCommand(unittest.TestCase):
         if not cls.STAT_BIN.exists():
             raise unittest.SkipTest(f"stat binary not found at {cls.STAT_BIN}")
 
-    def run_stat(self, *args):
+    def run_stat(self, *args, input=None):
         """Run the stat command with given arguments and return result."""
         cmd = [str(self.STAT_BIN)] + list(args)
         result = subprocess.run(
             cmd,
             capture_output=True,
             text=True,
+            input=input,
             env={**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
         )
         return result
@@ -259,5 +260,90 @@ class TestStatCommand(unittest.TestCase):
                 self.skipTest("Filesystem doesn't support quotes in filenames")
 
 
+    def make_files(self, tmpdir, count):
+        """Create count files whose size is their index; return their paths."""
+        paths = []
+        for i in range(count):
+            path = Path(tmpdir, f"f{i}")
+            path.write_bytes(b"x" * i)
+            paths.append(str(path))
+        return paths
+
+    def test_multiple_files(self):
+        """Test several FILEs print one block each."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            paths = self.make_files(tmpdir, 3)
+            result = self.run_stat(*paths)
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(result.stdout.count("File:"), 3)
+
+    def test_json_multiple_files_is_array(self):
+        """Test --json with several FILEs prints an array in argument order."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            paths = self.make_files(tmpdir, 3)
+            result = self.run_stat("--json", *paths, "/nonexistent/x")
+            self.assertNotEqual(result.returncode, 0)
+            data = json.loads(result.stdout)
+            self.assertEqual([d["path"] for d in data],
+                             paths + ["/nonexistent/x"])
+            self.assertEqual([d.get("size") for d in data[:3]], [0, 1, 2])
+            self.assertIn("error", data[3])
+
+    def test_json_stream(self):
+        """Test --json-stream prints one object per line."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            paths = self.make_files(tmpdir, 5)
+            result = self.run_stat("--json-stream", *paths)
+            self.assertEqual(result.returncode, 0)
+            lines = result.stdout.splitlines()
+            self.assertEqual(len(lines), 5)
+            for i, line in enumerate(lines):
+                obj = json.loads(line)
+                self.assertEqual(obj["path"], paths[i])
+                self.assertEqual(obj["size"], i)
+
+    def test_stdin0_with_fields(self):
+        """Test --stdin0 reads NUL-separated paths and --fields limits keys."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            paths = self.make_files(tmpdir, 10)
+            paths.append(str(Path(tmpdir, "name\nwith newline")))
+            Path(paths[-1]).write_bytes(b"abc")
+            result = self.run_stat("--stdin0", "--json-stream",
+                                   "--fields", "size,type",
+                                   input="\0".join(paths) + "\0")
+            self.assertEqual(result.returncode, 0)
+            objs = [json.loads(line) for line in result.stdout.splitlines()]
+            self.assertEqual([o["path"] for o in objs], paths)
+            self.assertEqual(set(objs[0]), {"path", "size", "type"})
+            self.assertEqual(objs[-1]["size"], 3)
+
+    def test_fields_text_output(self):
+        """Test --fields in text mode prints tab-separated values."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            paths = self.make_files(tmpdir, 3)
+            result = self.run_stat("--fields", "size,mode", *paths)
+            self.assertEqual(result.returncode, 0)
+            rows = [line.split("\t") for line in result.stdout.splitlines()]
+            self.assertEqual([r[0] for r in rows], paths)
+            self.assertEqual([r[1] for r in rows], ["0", "1", "2"])
+
+    def test_unknown_field(self):
+        """Test an unknown --fields name is rejected."""
+        result = self.run_stat("--fields", "size,colour", "/tmp")
+        self.assertNotEqual(result.returncode, 0)
+        self.assertIn("colour", result.stderr)
+
+    def test_parallel_keeps_order(self):
+        """Test --parallel gives the same output, in the same order."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            paths = self.make_files(tmpdir, 300)
+            data = "\0".join(paths)
+            serial = self.run_stat("--stdin0", "--json-stream", input=data)
+            parallel = self.run_stat("--stdin0", "--json-stream",
+                                     "--parallel", "8", input=data)
+            self.assertEqual(parallel.returncode, 0)
+            self.assertEqual(parallel.stdout, serial.stdout)
+            self.assertEqual(len(parallel.stdout.splitlines()), 300)
+
 if __name__ == "__main__":
     unittest.main()
@@ -3,8 +3,10 @@
 
 import json
 import os
+import signal
 import subprocess
 import tempfile
+import time
 import unittest
 from pathlib import Path
 
@@ -268,6 +270,110 @@ class TestTailCommand(unittest.TestCase):
         finally:
             os.unlink(temp_path)
 
+    def test_lines_spanning_read_blocks(self):
+        """Test lines longer than the backward-read block and blank lines."""
+        long_line = "x" * 200000
+        with tempfile.NamedTemporaryFile(mode="w", delete=False) as f:
+            f.write("head\n" + long_line + "\n\n" + long_line + "y\nend\n")
+            temp_path = f.name
+
+        try:
+            result = self.run_tail("-n", "3", temp_path)
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(result.stdout, "\n" + long_line + "y\nend\n")
+
+            result = self.run_tail("-n", "5", temp_path)
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(result.stdout.split("\n")[0], "head")
+        finally:
+            os.unlink(temp_path)
+
+    def test_pipe_input(self):
+        """Test reading from a pipe, which cannot seek."""
+        data = "".join(f"line{i}\n" for i in range(1, 1001)) + "tail"
+        cmd = [str(self.TAIL_BIN), "-n", "3", "/dev/stdin"]
+        result = subprocess.run(
+            cmd,
+            input=data,
+            capture_output=True,
+            text=True,
+            env={**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
+        )
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, "line999\nline1000\ntail\n")
+
+    def test_json_pipe_input(self):
+        """Test JSON output when reading from a pipe."""
+        cmd = [str(self.TAIL_BIN), "--json", "-n", "2", "/dev/stdin"]
+        result = subprocess.run(
+            cmd,
+            input="a\nb\n\"c\"\n",
+            capture_output=True,
+            text=True,
+            env={**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
+        )
+        self.assertEqual(result.returncode, 0)
+        data = json.loads(result.stdout)
+        self.assertEqual(data["lines"], ["b", "\"c\""])
+
+    def follow(self, path, *args, actions=()):
+        """Run tail with follow flags, apply actions, then interrupt it."""
+        proc = subprocess.Popen(
+            [str(self.TAIL_BIN)] + list(args) + [path],
+            stdout=subprocess.PIPE,
+            stderr=subprocess.PIPE,
+            text=True,
+            env={**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
+        )
+        time.sleep(0.3)
+        for action in actions:
+            action()
+            time.sleep(1.5)
+        proc.send_signal(signal.SIGINT)
+        stdout, stderr = proc.communicate(timeout=10)
+        return proc.returncode, stdout, stderr
+
+    def test_follow_appended_lines(self):
+        """Test -f prints data appended after startup."""
+        with tempfile.NamedTemporaryFile(mode="w", delete=False) as f:
+            f.write("old1\nold2\n")
+            temp_path = f.name
+
+        def append():
+            with open(temp_path, "a") as log:
+                log.write("new1\nnew2\n")
+
+        try:
+            code, stdout, _ = self.follow(temp_path, "-f", "-n", "1",
+                                          actions=[append])
+            self.assertEqual(code, 130)
+            self.assertEqual(stdout, "old2\nnew1\nnew2\n")
+        finally:
+            os.unlink(temp_path)
+
+    def test_follow_name_json_rotation(self):
+        """Test -F --json reopens a rotated file and emits NDJSON."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = os.path.join(tmpdir, "service.log")
+            with open(path, "w") as log:
+                log.write("start\n")
+
+            def rotate():
+                with open(path, "a") as log:
+                    log.write("before\n")
+                os.rename(path, path + ".1")
+                with open(path, "w") as log:
+                    log.write("after\n")
+
+            code, stdout, _ = self.follow(path, "-F", "--json",
+                                          actions=[rotate])
+            self.assertEqual(code, 130)
+            records = [json.loads(line) for line in stdout.splitlines()]
+            self.assertEqual(records[0]["lines"], ["start"])
+            self.assertEqual(
+                [r.get("line", r.get("event")) for r in records[1:]],
+                ["before", "reopened", "after"])
+
     def test_file_with_no_trailing_newline(self):
         """Test file without trailing newline."""
         with tempfile.NamedTemporaryFile(mode="w", delete=False) as f:
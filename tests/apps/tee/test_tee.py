@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+"""Unit tests for the tee command."""
+
+import json
+import os
+import subprocess
+import tempfile
+import unittest
+from pathlib import Path
+
+from tests.helpers import JShellRunner
+
+
+class TestTeeCommand(unittest.TestCase):
+    """Test cases for the tee command."""
+
+    TEE_BIN = Path(__file__).parent.parent.parent.parent / "bin" / "standalone-apps" / "tee"
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the tee binary exists before running tests."""
+        if not cls.TEE_BIN.exists():
+            raise unittest.SkipTest(f"tee binary not found at {cls.TEE_BIN}")
+
+    def setUp(self):
+        """Create a temporary directory for output files."""
+        self.tmp = tempfile.TemporaryDirectory()
+
+    def tearDown(self):
+        """Remove the temporary directory."""
+        self.tmp.cleanup()
+
+    def path(self, name):
+        """Path of a file in the temporary directory."""
+        return os.path.join(self.tmp.name, name)
+
+    def read(self, name):
+        """Bytes of a file in the temporary directory."""
+        with open(self.path(name), "rb") as f:
+            return f.read()
+
+    def run_tee(self, *args, input=b"", stdin=None):
+        """Run the tee command with given arguments and return result."""
+        cmd = [str(self.TEE_BIN)] + list(args)
+        return subprocess.run(
+            cmd,
+            input=None if stdin is not None else input,
+            stdin=stdin,
+            capture_output=True,
+            timeout=10,
+            env={**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
+        )
+
+    def test_help(self):
+        """Test --help flag shows help."""
+        result = self.run_tee("--help")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn(b"Usage: tee", result.stdout)
+        self.assertIn(b"--append", result.stdout)
+
+    def test_copies_to_stdout_and_files(self):
+        """Test a pipe is copied to stdout and every file."""
+        data = b"line\n" * 100000
+        result = self.run_tee(self.path("a"), self.path("b"), input=data)
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, data)
+        self.assertEqual(self.read("a"), data)
+        self.assertEqual(self.read("b"), data)
+
+    def test_file_input(self):
+        """Test a regular file on stdin is copied in full."""
+        data = os.urandom(3 * 1024 * 1024 + 17)
+        with open(self.path("in"), "wb") as f:
+            f.write(data)
+        with open(self.path("in"), "rb") as f:
+            result = self.run_tee(self.path("out"), stdin=f)
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, data)
+        self.assertEqual(self.read("out"), data)
+
+    def test_truncates_by_default(self):
+        """Test an existing file is overwritten."""
+        with open(self.path("a"), "wb") as f:
+            f.write(b"old contents that are longer\n")
+        result = self.run_tee(self.path("a"), input=b"new\n")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(self.read("a"), b"new\n")
+
+    def test_append(self):
+        """Test -a appends to an existing file."""
+        with open(self.path("a"), "wb") as f:
+            f.write(b"old\n")
+        result = self.run_tee("-a", self.path("a"), input=b"new\n")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, b"new\n")
+        self.assertEqual(self.read("a"), b"old\nnew\n")
+
+    def test_unwritable_file(self):
+        """Test a file that cannot be opened is reported and skipped."""
+        bad = self.path("missing/dir/file")
+        result = self.run_tee(bad, self.path("ok"), input=b"data\n")
+        self.assertEqual(result.returncode, 1)
+        self.assertIn(b"tee: " + bad.encode(), result.stderr)
+        self.assertEqual(result.stdout, b"data\n")
+        self.assertEqual(self.read("ok"), b"data\n")
+
+    def test_json_report(self):
+        """Test --json copies to files only and reports them."""
+        bad = self.path("missing/file")
+        result = self.run_tee("--json", self.path("a"), bad,
+                              input=b"12345")
+        self.assertEqual(result.returncode, 1)
+        report = json.loads(result.stdout)
+        self.assertEqual(report["bytes"], 5)
+        self.assertEqual(report["files"][0], {"path": self.path("a")})
+        self.assertIn("error", report["files"][1])
+        self.assertEqual(self.read("a"), b"12345")
+
+    def test_empty_input(self):
+        """Test empty input creates empty files."""
+        result = self.run_tee(self.path("a"))
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, b"")
+        self.assertEqual(self.read("a"), b"")
+
+    def test_in_pipeline(self):
+        """Test tee as a jshell pipeline stage feeding another stage."""
+        if not JShellRunner.exists():
+            self.skipTest("jshell binary not found")
+        src = self.path("src")
+        with open(src, "w") as f:
+            f.write("".join(f"line {i}\n" for i in range(20000)))
+        result = JShellRunner.run(
+            f"cat {src} | tee {self.path('copy')} | head -n 2")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, "line 0\nline 1\n")
+        with open(src, "rb") as f:
+            self.assertEqual(self.read("copy"), f.read())
+
+
+if __name__ == "__main__":
+    unittest.main()
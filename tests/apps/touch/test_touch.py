@@ -21,11 +21,12 @@ class TestTouchCommand(unittest.TestCase):
         if not cls.TOUCH_BIN.exists():
             raise unittest.SkipTest(f"touch binary not found at {cls.TOUCH_BIN}")
 
-    def run_touch(self, *args):
+    def run_touch(self, *args, input=None):
         """Run the touch command with given arguments and return result."""
         cmd = [str(self.TOUCH_BIN)] + list(args)
         result = subprocess.run(
             cmd,
+            input=input,
             capture_output=True,
             text=True,
             env={**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
@@ -186,6 +187,44 @@ class TestTouchCommand(unittest.TestCase):
             self.assertEqual(result.returncode, 0)
             self.assertEqual(existing.read_bytes(), binary_content)
 
+    def test_stdin0_batch(self):
+        """Test --stdin0 creates many files across nested directories."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            dirs = [Path(tmpdir, f"a{i}", "b") for i in range(400)]
+            for d in dirs:
+                d.mkdir(parents=True)
+            paths = [str(dirs[i % len(dirs)] / f"f{i}") for i in range(2000)]
+
+            result = self.run_touch("--stdin0",
+                                    input="\0".join(paths) + "\0")
+            self.assertEqual(result.returncode, 0, result.stderr)
+            for path in paths:
+                self.assertTrue(Path(path).is_file(), path)
+
+    def test_stdin0_updates_existing(self):
+        """Test --stdin0 updates timestamps of existing files."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            existing = Path(tmpdir, "existing.txt")
+            existing.write_text("content")
+            old = time.time() - 3600
+            os.utime(existing, (old, old))
+
+            result = self.run_touch("--stdin0", input=f"{existing}\0")
+            self.assertEqual(result.returncode, 0)
+            self.assertGreater(existing.stat().st_mtime, old + 1800)
+            self.assertEqual(existing.read_text(), "content")
+
+    def test_relative_and_trailing_paths(self):
+        """Test bare names resolve against the working directory."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            Path(tmpdir, "sub").mkdir()
+            cmd = [str(self.TOUCH_BIN), "bare", "./sub/../sub/inner"]
+            result = subprocess.run(cmd, cwd=tmpdir, capture_output=True,
+                                    text=True)
+            self.assertEqual(result.returncode, 0, result.stderr)
+            self.assertTrue(Path(tmpdir, "bare").is_file())
+            self.assertTrue(Path(tmpdir, "sub", "inner").is_file())
+
 
 if __name__ == "__main__":
     unittest.main()
@@ -2,8 +2,12 @@
 """Unit tests for the vi command."""
 
 import os
+import pty
+import select
+import signal
 import subprocess
 import tempfile
+import time
 import unittest
 from pathlib import Path
 
@@ -171,5 +175,247 @@ class TestViHelpContent(unittest.TestCase):
         self.assertIn("/", help_text)  # Search forward
 
 
+class TestViEditing(unittest.TestCase):
+    """Drive vi on a pseudo-terminal and check the saved file."""
+
+    VI_BIN = Path(__file__).parent.parent.parent.parent / "bin" / "standalone-apps" / "vi"
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the vi binary exists before running tests."""
+        if not cls.VI_BIN.exists():
+            raise unittest.SkipTest(f"vi binary not found at {cls.VI_BIN}")
+
+    def edit(self, path, keys, options=(), terminate=False):
+        """Run vi on path, typing each string in keys, and wait for exit.
+
+        With terminate, vi is sent SIGTERM after the last key.
+        """
+        pid, fd = pty.fork()
+        if pid == 0:
+            os.environ["ASAN_OPTIONS"] = "detect_leaks=0"
+            os.execv(str(self.VI_BIN),
+                     [str(self.VI_BIN), *options, path])
+
+        def drain(seconds):
+            end = time.time() + seconds
+            while time.time() < end:
+                ready, _, _ = select.select([fd], [], [], 0.02)
+                if ready:
+                    try:
+                        os.read(fd, 65536)
+                    except OSError:
+                        return
+
+        try:
+            drain(0.3)
+            for key in keys:
+                os.write(fd, key.encode())
+                # Longer than the escape sequence timeout, so ESC stands alone
+                drain(0.15)
+            drain(0.3)
+            if terminate:
+                os.kill(pid, signal.SIGTERM)
+            _, status = os.waitpid(pid, 0)
+            return status
+        finally:
+            os.close(fd)
+
+    def test_edit_lines_and_save(self):
+        """Test line and character edits are saved."""
+        with tempfile.NamedTemporaryFile(mode="w", delete=False) as f:
+            f.write("hello world\nsecond line\nthird\n")
+            path = f.name
+        try:
+            status = self.edit(path, ["x", "j", "dd", "p", "G", "o", "end",
+                                      "\x1b", "gg", "A", "!", "\r", "mid",
+                                      "\x1b", ":wq", "\r"])
+            self.assertEqual(status, 0)
+            with open(path) as f:
+                self.assertEqual(f.read(), "ello world!\nmid\nthird\n"
+                                           "second line\nend\n")
+        finally:
+            os.unlink(path)
+
+    def test_join_lines_and_search(self):
+        """Test backspace joins lines and search moves the cursor."""
+        with tempfile.NamedTemporaryFile(mode="w", delete=False) as f:
+            f.write("abc\ndef")
+            path = f.name
+        try:
+            status = self.edit(path, ["j", "i", "\x7f", "Z", "\x1b", "/ab",
+                                      "\r", "x", ":wq", "\r"])
+            self.assertEqual(status, 0)
+            with open(path) as f:
+                self.assertEqual(f.read(), "bcZdef\n")
+        finally:
+            os.unlink(path)
+
+    def test_save_keeps_mode(self):
+        """Test saving through a temporary file keeps the permissions."""
+        with tempfile.NamedTemporaryFile(mode="w", delete=False) as f:
+            f.write("text\n")
+            path = f.name
+        try:
+            os.chmod(path, 0o640)
+            status = self.edit(path, ["x", ":wq", "\r"])
+            self.assertEqual(status, 0)
+            self.assertEqual(os.stat(path).st_mode & 0o777, 0o640)
+            with open(path) as f:
+                self.assertEqual(f.read(), "ext\n")
+        finally:
+            os.unlink(path)
+
+    def test_undo_and_redo(self):
+        """Test u undoes a whole insert and a dd, and Ctrl-R redoes."""
+        with tempfile.NamedTemporaryFile(mode="w", delete=False) as f:
+            f.write("one\ntwo\nthree\n")
+            path = f.name
+        try:
+            status = self.edit(path, ["dd", "A", "!", "!", "\x1b", "u", "u",
+                                      "\x12", ":wq", "\r"])
+            self.assertEqual(status, 0)
+            with open(path) as f:
+                self.assertEqual(f.read(), "two\nthree\n")
+        finally:
+            os.unlink(path)
+
+    def test_undo_back_to_saved_text_quits(self):
+        """Test undoing every change leaves the buffer unmodified."""
+        with tempfile.NamedTemporaryFile(mode="w", delete=False) as f:
+            f.write("one\n")
+            path = f.name
+        try:
+            status = self.edit(path, ["x", "u", ":q", "\r"])
+            self.assertEqual(status, 0)
+            with open(path) as f:
+                self.assertEqual(f.read(), "one\n")
+        finally:
+            os.unlink(path)
+
+    def test_undo_branches_in_time_order(self):
+        """Test g- reaches a change undone before editing on."""
+        with tempfile.NamedTemporaryFile(mode="w", delete=False) as f:
+            f.write("one\n")
+            path = f.name
+        try:
+            status = self.edit(path, ["x", "u", "A", "Z", "\x1b", "g-",
+                                      ":wq", "\r"])
+            self.assertEqual(status, 0)
+            with open(path) as f:
+                self.assertEqual(f.read(), "ne\n")
+        finally:
+            os.unlink(path)
+
+    def test_recover_from_swap_file(self):
+        """Test edits journaled before SIGTERM are replayed by -r."""
+        with tempfile.NamedTemporaryFile(mode="w", delete=False) as f:
+            f.write("one\ntwo\nthree\n")
+            path = f.name
+        swap = path + ".swp"
+        try:
+            self.edit(path, ["j", "A", "!", "\x1b", "G", "dd", "gg", "x",
+                             "x"], terminate=True)
+            self.assertTrue(os.path.exists(swap))
+            with open(path) as f:
+                self.assertEqual(f.read(), "one\ntwo\nthree\n")
+
+            status = self.edit(path, [":wq", "\r"], options=["-r"])
+            self.assertEqual(status, 0)
+            with open(path) as f:
+                self.assertEqual(f.read(), "e\ntwo!\n")
+            self.assertFalse(os.path.exists(swap))
+        finally:
+            os.unlink(path)
+            if os.path.exists(swap):
+                os.unlink(swap)
+
+    def test_bracketed_paste(self):
+        """Test pasted text is inserted as is and undoes as one step."""
+        with tempfile.NamedTemporaryFile(mode="w", delete=False) as f:
+            f.write("ab\n")
+            path = f.name
+        paste = "\x1b[200~x\rdd\ty\r\nz\x1b[201~"
+        try:
+            status = self.edit(path, ["l", paste, ":wq", "\r"])
+            self.assertEqual(status, 0)
+            with open(path) as f:
+                self.assertEqual(f.read(), "ax\ndd\ty\nzb\n")
+
+            status = self.edit(path, ["A", paste, "!", "\x1b", "u",
+                                      ":wq", "\r"])
+            self.assertEqual(status, 0)
+            with open(path) as f:
+                self.assertEqual(f.read(), "ax\ndd\ty\nzb\n")
+        finally:
+            os.unlink(path)
+
+    def test_substitute(self):
+        """Test :s with ranges, groups and flags, and u undoing it whole."""
+        with tempfile.NamedTemporaryFile(mode="w", delete=False) as f:
+            f.write("foo bar foo\nbaz\nFoo foo\n")
+            path = f.name
+        try:
+            status = self.edit(path, [":%s/foo/X/g", "\r", ":w", "\r",
+                                      ":2,3s/([a-z]+)$/<\\1>/", "\r",
+                                      ":1s/x/&&/i", "\r", ":wq", "\r"])
+            self.assertEqual(status, 0)
+            with open(path) as f:
+                self.assertEqual(f.read(), "XX bar X\n<baz>\nFoo X\n")
+
+            status = self.edit(path, [":%s/X|o/-/g", "\r", "u", ":wq",
+                                      "\r"])
+            self.assertEqual(status, 0)
+            with open(path) as f:
+                self.assertEqual(f.read(), "XX bar X\n<baz>\nFoo X\n")
+        finally:
+            os.unlink(path)
+
+    def test_substitute_large_file(self):
+        """Test :%s over many pieces and lines split between them."""
+        lines = [f"line {i} foo {'x' * (i % 50)}" for i in range(50000)]
+        with tempfile.NamedTemporaryFile(mode="w", delete=False) as f:
+            f.write("\n".join(lines) + "\n")
+            path = f.name
+        try:
+            status = self.edit(path, ["G", "o", "foo tail", "\x1b",
+                                      ":%s/foo|^line/[&]/g", "\r", ":wq",
+                                      "\r"])
+            self.assertEqual(status, 0)
+            expected = [f"[line] {i} [foo] {'x' * (i % 50)}"
+                        for i in range(50000)] + ["[foo] tail"]
+            with open(path) as f:
+                self.assertEqual(f.read(), "\n".join(expected) + "\n")
+        finally:
+            os.unlink(path)
+
+    def test_search_regex(self):
+        """Test / takes a regular expression and n repeats it."""
+        with tempfile.NamedTemporaryFile(mode="w", delete=False) as f:
+            f.write("a1\nb22\nc333\n")
+            path = f.name
+        try:
+            status = self.edit(path, ["/[0-9]{2}$", "\r", "x", "n", "x",
+                                      ":wq", "\r"])
+            self.assertEqual(status, 0)
+            with open(path) as f:
+                self.assertEqual(f.read(), "a1\nb2\nc33\n")
+        finally:
+            os.unlink(path)
+
+    def test_typed_ahead_keys(self):
+        """Test keys arriving together are each handled."""
+        with tempfile.NamedTemporaryFile(mode="w", delete=False) as f:
+            f.write("one\n")
+            path = f.name
+        try:
+            status = self.edit(path, ["A two\x1b0x:wq\r"])
+            self.assertEqual(status, 0)
+            with open(path) as f:
+                self.assertEqual(f.read(), "ne two\n")
+        finally:
+            os.unlink(path)
+
+
 if __name__ == "__main__":
     unittest.main()
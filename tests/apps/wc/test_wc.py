@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+"""Unit tests for the wc command."""
+
+import json
+import os
+import subprocess
+import tempfile
+import unittest
+from pathlib import Path
+
+
+class TestWcCommand(unittest.TestCase):
+    """Test cases for the wc command."""
+
+    WC_BIN = Path(__file__).parent.parent.parent.parent / "bin" / "standalone-apps" / "wc"
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the wc binary exists before running tests."""
+        if not cls.WC_BIN.exists():
+            raise unittest.SkipTest(f"wc binary not found at {cls.WC_BIN}")
+
+    def setUp(self):
+        """Create files to count."""
+        self.tmpdir = tempfile.TemporaryDirectory()
+        self.root = self.tmpdir.name
+        Path(self.root, "a.txt").write_text("one two\nthree\n")
+        Path(self.root, "b.txt").write_text("  four\tfive  six")
+        Path(self.root, "empty").write_text("")
+
+    def tearDown(self):
+        self.tmpdir.cleanup()
+
+    def run_wc(self, *args, input=None):
+        """Run the wc command with given arguments and return result."""
+        cmd = [str(self.WC_BIN)] + list(args)
+        result = subprocess.run(
+            cmd,
+            input=input,
+            capture_output=True,
+            text=isinstance(input, str) or input is None,
+            cwd=self.root,
+            env={**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
+        )
+        return result
+
+    def counts(self, result):
+        """Split each output line into its fields."""
+        return [line.split() for line in result.stdout.splitlines()]
+
+    def test_help(self):
+        """Test --help shows usage."""
+        result = self.run_wc("--help")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("Usage: wc", result.stdout)
+
+    def test_all_counts(self):
+        """Test lines, words and bytes of one file."""
+        result = self.run_wc("a.txt")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(self.counts(result), [["2", "3", "14", "a.txt"]])
+
+    def test_total(self):
+        """Test several files get a total line, in argument order."""
+        result = self.run_wc("b.txt", "a.txt", "empty")
+        self.assertEqual(self.counts(result), [
+            ["0", "3", "16", "b.txt"],
+            ["2", "3", "14", "a.txt"],
+            ["0", "0", "0", "empty"],
+            ["2", "6", "30", "total"],
+        ])
+
+    def test_columns_aligned(self):
+        """Test columns are as wide as the widest count."""
+        result = self.run_wc("a.txt", "b.txt")
+        widths = {len(line) for line in result.stdout.splitlines()
+                  if not line.endswith("total")}
+        self.assertEqual(result.stdout.splitlines()[0], " 2  3 14 a.txt")
+        self.assertEqual(len(widths), 1)
+
+    def test_single_field(self):
+        """Test -l, -w and -c select counts."""
+        self.assertEqual(self.run_wc("-l", "a.txt").stdout, "2 a.txt\n")
+        self.assertEqual(self.run_wc("-w", "b.txt").stdout, "3 b.txt\n")
+        self.assertEqual(self.run_wc("-c", "a.txt").stdout, "14 a.txt\n")
+        self.assertEqual(self.counts(self.run_wc("-l", "-c", "a.txt")),
+                         [["2", "14", "a.txt"]])
+
+    def test_stdin(self):
+        """Test standard input is counted without a name."""
+        result = self.run_wc(input="x y\nz\n")
+        self.assertEqual(self.counts(result), [["2", "3", "6"]])
+        result = self.run_wc("-l", "-", input="a\nb\nc\n")
+        self.assertEqual(result.stdout, "3 -\n")
+
+    def test_words_across_blocks(self):
+        """Test words are counted across word and block boundaries."""
+        data = b"".join(b"w%d%s" % (i, b" \t\n\r\x0b\x0c"[i % 6:i % 6 + 1])
+                        for i in range(100000))
+        Path(self.root, "big").write_bytes(data)
+        result = self.run_wc("big")
+        self.assertEqual(self.counts(result),
+                         [[str(data.count(b"\n")), str(len(data.split())),
+                           str(len(data)), "big"]])
+        piped = self.run_wc(input=data)
+        self.assertEqual(piped.stdout.split(), [str(data.count(b"\n")).encode(),
+                                                str(len(data.split())).encode(),
+                                                str(len(data)).encode()])
+
+    def test_non_ascii_is_word(self):
+        """Test bytes outside ASCII are part of words."""
+        result = self.run_wc("-w", input="café — ok\n")
+        self.assertEqual(result.stdout.strip(), "3")
+
+    def test_json(self):
+        """Test --json prints an array of counts."""
+        result = self.run_wc("--json", "-l", "a.txt", "b.txt")
+        self.assertEqual(result.returncode, 0)
+        data = json.loads(result.stdout)
+        self.assertEqual(data, [{"path": "a.txt", "lines": 2},
+                                {"path": "b.txt", "lines": 0}])
+
+    def test_missing_file(self):
+        """Test a missing file is reported and the rest still counted."""
+        result = self.run_wc("-l", "nosuch", "a.txt")
+        self.assertEqual(result.returncode, 1)
+        self.assertIn("nosuch", result.stderr)
+        self.assertEqual(self.counts(result), [["2", "a.txt"], ["2", "total"]])
+
+    def test_directory(self):
+        """Test a directory is an error."""
+        os.mkdir(os.path.join(self.root, "d"))
+        result = self.run_wc("d")
+        self.assertEqual(result.returncode, 1)
+        self.assertIn("Is a directory", result.stderr)
+
+    def test_many_files(self):
+        """Test many files counted in parallel keep their order."""
+        names = []
+        for i in range(50):
+            name = f"f{i:02d}"
+            Path(self.root, name).write_text("x\n" * i)
+            names.append(name)
+        result = self.run_wc("-l", *names)
+        self.assertEqual(self.counts(result)[:-1],
+                         [[str(i), f"f{i:02d}"] for i in range(50)])
+        self.assertEqual(self.counts(result)[-1], [str(sum(range(50))), "total"])
+
+
+if __name__ == "__main__":
+    unittest.main()
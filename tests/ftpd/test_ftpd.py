@@ -1,12 +1,21 @@
 #!/usr/bin/env python3
 """Unit tests for the FTP server (ftpd)."""
 
+import ftplib
+import hashlib
+import io
+import json
 import os
+import re
+import shutil
 import socket
+import ssl
 import subprocess
 import tempfile
 import time
 import unittest
+import zlib
+from concurrent.futures import ThreadPoolExecutor
 from pathlib import Path
 
 
@@ -15,6 +24,7 @@ class FtpdTestCase(unittest.TestCase):
 
     FTPD_BIN = Path(__file__).parent.parent.parent / "bin" / "ftpd"
     SERVER_PORT = 21521  # Use different port for tests
+    SERVER_ARGS = []  # Extra ftpd options
     server_proc = None
     test_root = None
 
@@ -34,7 +44,8 @@ class FtpdTestCase(unittest.TestCase):
 
         # Start server
         cls.server_proc = subprocess.Popen(
-            [str(cls.FTPD_BIN), "-p", str(cls.SERVER_PORT), "-r", cls.test_root],
+            [str(cls.FTPD_BIN), "-p", str(cls.SERVER_PORT), "-r", cls.test_root,
+             *cls.SERVER_ARGS],
             stdout=subprocess.PIPE,
             stderr=subprocess.PIPE,
             env={**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
@@ -89,6 +100,31 @@ class FtpdTestCase(unittest.TestCase):
                 break
         return data.decode().strip()
 
+    def login(self):
+        """Connect and log in, returning the control socket."""
+        sock = self.ftp_connect()
+        self.ftp_recv(sock)
+        self.ftp_send(sock, "USER testuser")
+        self.ftp_recv(sock)
+        return sock
+
+    def epsv(self, sock):
+        """Send EPSV and return the data port it gives."""
+        self.ftp_send(sock, "EPSV")
+        response = self.ftp_recv(sock)
+        self.assertEqual(self.ftp_get_code(response), 229)
+        return int(response.split("|||")[1].split("|")[0])
+
+    def read_all(self, conn):
+        """Read a data connection to its end."""
+        conn.settimeout(5)
+        data = b""
+        while True:
+            chunk = conn.recv(4096)
+            if not chunk:
+                return data
+            data += chunk
+
     def ftp_get_code(self, response):
         """Extract the response code from an FTP response."""
         if response and len(response) >= 3:
@@ -140,6 +176,20 @@ class TestFtpdConnection(FtpdTestCase):
         finally:
             sock.close()
 
+    def test_auth_without_tls(self):
+        """Test AUTH TLS is refused when no certificate is configured."""
+        sock = self.ftp_connect()
+        try:
+            self.ftp_recv(sock)
+            self.ftp_send(sock, "AUTH TLS")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 502)
+            self.ftp_send(sock, "PBSZ 0")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 503)
+            self.ftp_send(sock, "USER testuser")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 230)
+        finally:
+            sock.close()
+
     def test_syst_command(self):
         """Test SYST command returns 215."""
         sock = self.ftp_connect()
@@ -192,6 +242,41 @@ class TestFtpdConnection(FtpdTestCase):
         finally:
             sock.close()
 
+    def test_pipelined_commands(self):
+        """Test several commands sent at once are all answered in order."""
+        sock = self.ftp_connect()
+        try:
+            self.ftp_recv(sock)  # Welcome
+
+            sock.send(b"SYST\r\nNOOP\nXYZZY\r\nNOOP\r\n")
+            replies = b""
+            while replies.count(b"\r\n") < 4:
+                chunk = sock.recv(1024)
+                if not chunk:
+                    break
+                replies += chunk
+            codes = [self.ftp_get_code(line) for line in
+                     replies.decode().split("\r\n") if line]
+            self.assertEqual(codes, [215, 200, 500, 200])
+        finally:
+            sock.close()
+
+    def test_command_split_across_sends(self):
+        """Test a command arriving in pieces is answered once complete."""
+        sock = self.ftp_connect()
+        try:
+            self.ftp_recv(sock)  # Welcome
+
+            sock.send(b"SY")
+            time.sleep(0.1)
+            sock.send(b"ST\r")
+            time.sleep(0.1)
+            sock.send(b"\n")
+            response = self.ftp_recv(sock)
+            self.assertEqual(self.ftp_get_code(response), 215)
+        finally:
+            sock.close()
+
 
 class TestFtpdNavigation(FtpdTestCase):
     """Test directory navigation commands."""
@@ -452,6 +537,786 @@ class TestFtpdDataTransfer(FtpdTestCase):
             if upload_path.exists():
                 upload_path.unlink()
 
+    def test_large_file_round_trip(self):
+        """Test a multi-megabyte file survives STOR then RETR."""
+        sock = self.ftp_connect()
+        payload = os.urandom(5 * 1024 * 1024 + 123)
+        upload_name = f"large_{os.getpid()}.bin"
+        upload_path = Path(self.test_root) / upload_name
+
+        try:
+            self.ftp_recv(sock)
+            self.ftp_send(sock, "USER testuser")
+            self.ftp_recv(sock)
+
+            data_sock, data_port = self.setup_data_listener()
+            try:
+                self.ftp_send(sock,
+                              f"PORT {self.port_command_args(data_port)}")
+                self.ftp_recv(sock)
+                self.ftp_send(sock, f"STOR {upload_name}")
+                self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 150)
+                conn, _ = data_sock.accept()
+                conn.sendall(payload)
+                conn.close()
+                self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 226)
+            finally:
+                data_sock.close()
+            self.assertEqual(upload_path.read_bytes(), payload)
+
+            data_sock, data_port = self.setup_data_listener()
+            try:
+                self.ftp_send(sock,
+                              f"PORT {self.port_command_args(data_port)}")
+                self.ftp_recv(sock)
+                self.ftp_send(sock, f"RETR {upload_name}")
+                self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 150)
+                conn, _ = data_sock.accept()
+                conn.settimeout(5)
+                content = b""
+                while True:
+                    chunk = conn.recv(65536)
+                    if not chunk:
+                        break
+                    content += chunk
+                conn.close()
+                self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 226)
+            finally:
+                data_sock.close()
+            self.assertEqual(content, payload)
+        finally:
+            sock.close()
+            upload_path.unlink(missing_ok=True)
+
+
+class TestFtpdPassive(FtpdTestCase):
+    """Test passive mode data connections (PASV, EPSV)."""
+
+    def pasv(self, sock):
+        """Send PASV and return the data address it gives."""
+        self.ftp_send(sock, "PASV")
+        response = self.ftp_recv(sock)
+        self.assertEqual(self.ftp_get_code(response), 227)
+        fields = response[response.index("(") + 1:response.index(")")]
+        h1, h2, h3, h4, p1, p2 = (int(f) for f in fields.split(","))
+        return f"{h1}.{h2}.{h3}.{h4}", p1 * 256 + p2
+
+    def test_pasv_retr(self):
+        """Test RETR over a PASV data connection."""
+        sock = self.login()
+        try:
+            host, port = self.pasv(sock)
+            self.assertEqual(host, "127.0.0.1")
+            conn = socket.create_connection((host, port), timeout=5)
+            self.ftp_send(sock, "RETR testfile.txt")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 150)
+            self.assertEqual(self.read_all(conn), b"Hello, FTP!\n")
+            conn.close()
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 226)
+        finally:
+            sock.close()
+
+    def test_epsv_list_repeated(self):
+        """Test several LISTs, each over a new EPSV data connection."""
+        sock = self.login()
+        try:
+            for _ in range(3):
+                port = self.epsv(sock)
+                conn = socket.create_connection(("127.0.0.1", port),
+                                                timeout=5)
+                self.ftp_send(sock, "LIST")
+                self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 150)
+                self.assertIn(b"testfile.txt", self.read_all(conn))
+                conn.close()
+                self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 226)
+        finally:
+            sock.close()
+
+    def test_epsv_other_protocol(self):
+        """Test EPSV for a protocol other than IPv4 returns 522."""
+        sock = self.login()
+        try:
+            self.ftp_send(sock, "EPSV 2")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 522)
+        finally:
+            sock.close()
+
+    def test_pasv_requires_auth(self):
+        """Test PASV before login returns 530."""
+        sock = self.ftp_connect()
+        try:
+            self.ftp_recv(sock)
+            self.ftp_send(sock, "PASV")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 530)
+        finally:
+            sock.close()
+
+    def test_port_other_address_rejected(self):
+        """Test PORT naming an address other than the client's."""
+        sock = self.login()
+        try:
+            self.ftp_send(sock, "PORT 10,1,2,3,200,10")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 501)
+        finally:
+            sock.close()
+
+
+class TestFtpdPassiveRange(TestFtpdPassive):
+    """Test passive mode limited to a port range."""
+
+    SERVER_PORT = 21522
+    SERVER_ARGS = ["--pasv-ports", "47400-47403",
+                   "--pasv-address", "127.0.0.1"]
+
+    def test_ports_in_range(self):
+        """Test PASV ports come from the configured range."""
+        sock = self.login()
+        try:
+            for _ in range(6):
+                _, port = self.pasv(sock)
+                self.assertTrue(47400 <= port <= 47403, port)
+        finally:
+            sock.close()
+
+
+class TestFtpdRestart(FtpdTestCase):
+    """Test REST, APPE, SIZE and MDTM for resumable transfers."""
+
+    def test_size_and_mdtm(self):
+        """Test SIZE and MDTM report a file's size and time."""
+        sock = self.login()
+        try:
+            self.ftp_send(sock, "SIZE testfile.txt")
+            self.assertEqual(self.ftp_recv(sock), "213 12")
+
+            self.ftp_send(sock, "MDTM testfile.txt")
+            response = self.ftp_recv(sock)
+            self.assertEqual(self.ftp_get_code(response), 213)
+            mtime = (Path(self.test_root) / "testfile.txt").stat().st_mtime
+            self.assertEqual(response[4:],
+                             time.strftime("%Y%m%d%H%M%S", time.gmtime(mtime)))
+
+            self.ftp_send(sock, "SIZE subdir")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 550)
+        finally:
+            sock.close()
+
+    def test_rest_retr(self):
+        """Test RETR after REST sends the rest of the file."""
+        sock = self.login()
+        try:
+            self.ftp_send(sock, "REST 7")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 350)
+            conn = socket.create_connection(("127.0.0.1", self.epsv(sock)),
+                                            timeout=5)
+            self.ftp_send(sock, "RETR testfile.txt")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 150)
+            self.assertEqual(self.read_all(conn), b"FTP!\n")
+            conn.close()
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 226)
+
+            # The offset applied to that transfer only
+            conn = socket.create_connection(("127.0.0.1", self.epsv(sock)),
+                                            timeout=5)
+            self.ftp_send(sock, "RETR testfile.txt")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 150)
+            self.assertEqual(self.read_all(conn), b"Hello, FTP!\n")
+            conn.close()
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 226)
+        finally:
+            sock.close()
+
+    def test_rest_beyond_end(self):
+        """Test RETR after REST past the end of the file returns 554."""
+        sock = self.login()
+        try:
+            self.epsv(sock)
+            self.ftp_send(sock, "REST 1000")
+            self.ftp_recv(sock)
+            self.ftp_send(sock, "RETR testfile.txt")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 554)
+
+            self.ftp_send(sock, "REST -1")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 501)
+        finally:
+            sock.close()
+
+    def test_rest_stor_and_appe(self):
+        """Test STOR after REST and APPE both resume an upload."""
+        name = f"resume_{os.getpid()}.txt"
+        path = Path(self.test_root) / name
+        path.write_bytes(b"0123456789")
+        sock = self.login()
+        try:
+            self.ftp_send(sock, "REST 4")
+            self.ftp_recv(sock)
+            conn = socket.create_connection(("127.0.0.1", self.epsv(sock)),
+                                            timeout=5)
+            self.ftp_send(sock, f"STOR {name}")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 150)
+            conn.sendall(b"abc")
+            conn.close()
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 226)
+            self.assertEqual(path.read_bytes(), b"0123abc")
+
+            conn = socket.create_connection(("127.0.0.1", self.epsv(sock)),
+                                            timeout=5)
+            self.ftp_send(sock, f"APPE {name}")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 150)
+            conn.sendall(b"XYZ")
+            conn.close()
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 226)
+            self.assertEqual(path.read_bytes(), b"0123abcXYZ")
+        finally:
+            sock.close()
+            path.unlink(missing_ok=True)
+
+    def test_allo_syntax(self):
+        """Test ALLO takes a size and an optional record size."""
+        sock = self.login()
+        try:
+            self.ftp_send(sock, "ALLO 4096")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 200)
+            self.ftp_send(sock, "ALLO 4096 R 512")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 200)
+            self.ftp_send(sock, "ALLO lots")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 501)
+        finally:
+            sock.close()
+
+    def test_allo_stor(self):
+        """Test uploads after ALLO, shorter and longer than announced."""
+        name = f"allo_{os.getpid()}.bin"
+        path = Path(self.test_root) / name
+        sock = self.login()
+        try:
+            for announced, data in ((1 << 20, b"short"),
+                                    (1024, os.urandom(20 * 1024 * 1024))):
+                self.ftp_send(sock, f"ALLO {announced}")
+                self.ftp_recv(sock)
+                conn = socket.create_connection(
+                    ("127.0.0.1", self.epsv(sock)), timeout=5)
+                self.ftp_send(sock, f"STOR {name}")
+                self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 150)
+                conn.sendall(data)
+                conn.close()
+                self.assertEqual(
+                    self.ftp_get_code(self.ftp_recv(sock)), 226)
+                self.assertEqual(path.read_bytes(), data)
+        finally:
+            sock.close()
+            path.unlink(missing_ok=True)
+
+
+class TestFtpdListing(FtpdTestCase):
+    """Test MLSD, MLST and FEAT, and listing large directories."""
+
+    def recv_reply(self, sock, code):
+        """Receive a multi-line reply ending in a line with the code."""
+        data = b""
+        while not re.search(rb"(^|\r\n)%d [^\r\n]*\r\n$" % code, data):
+            chunk = sock.recv(4096)
+            if not chunk:
+                break
+            data += chunk
+        return data.decode()
+
+    def mlsd(self, sock, path=None):
+        """Run MLSD and return its entries as a dict of name to facts."""
+        conn = socket.create_connection(("127.0.0.1", self.epsv(sock)),
+                                        timeout=5)
+        self.ftp_send(sock, f"MLSD {path}" if path else "MLSD")
+        self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 150)
+        data = self.read_all(conn).decode()
+        conn.close()
+        self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 226)
+
+        entries = {}
+        for line in data.split("\r\n"):
+            if not line:
+                continue
+            facts, name = line.split(" ", 1)
+            entries[name] = dict(f.split("=", 1)
+                                 for f in facts.rstrip(";").split(";"))
+        return entries
+
+    def test_feat(self):
+        """Test FEAT names the extensions, MLST among them."""
+        sock = self.ftp_connect()
+        try:
+            self.ftp_recv(sock)
+            self.ftp_send(sock, "FEAT")
+            reply = self.recv_reply(sock, 211)
+            self.assertTrue(reply.startswith("211-"))
+            self.assertIn(" MLST type*;size*;modify*;perm*;\r\n", reply)
+            self.assertIn(" REST STREAM\r\n", reply)
+            self.assertIn(" MODE Z\r\n", reply)
+        finally:
+            sock.close()
+
+    def test_mlsd(self):
+        """Test MLSD gives the same facts in the same order for each entry."""
+        sock = self.login()
+        try:
+            entries = self.mlsd(sock)
+            self.assertEqual(entries["testfile.txt"]["type"], "file")
+            self.assertEqual(entries["testfile.txt"]["size"], "12")
+            self.assertEqual(entries["subdir"]["type"], "dir")
+            self.assertIn("e", entries["subdir"]["perm"])
+            for facts in entries.values():
+                self.assertEqual(list(facts),
+                                 ["type", "size", "modify", "perm"])
+                self.assertRegex(facts["modify"], r"^\d{14}$")
+
+            self.assertEqual(list(self.mlsd(sock, "subdir")), ["nested.txt"])
+
+            self.epsv(sock)
+            self.ftp_send(sock, "MLSD nosuchdir")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 550)
+        finally:
+            sock.close()
+
+    def test_mlst(self):
+        """Test MLST gives one file's facts over the control connection."""
+        sock = self.login()
+        try:
+            self.ftp_send(sock, "MLST testfile.txt")
+            reply = self.recv_reply(sock, 250)
+            lines = reply.split("\r\n")
+            self.assertTrue(lines[0].startswith("250-"))
+            self.assertRegex(
+                lines[1],
+                r"^ type=file;size=12;modify=\d{14};perm=[a-z]*; "
+                r"/testfile.txt$")
+            self.assertTrue(lines[2].startswith("250 "))
+
+            self.ftp_send(sock, "MLST nosuchfile")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 550)
+        finally:
+            sock.close()
+
+    def test_large_directory(self):
+        """Test LIST and MLSD of a directory of thousands of files."""
+        big = Path(self.test_root) / "bigdir"
+        big.mkdir()
+        names = {f"upload_{i:05d}.dat" for i in range(5000)}
+        for name in names:
+            (big / name).touch()
+        try:
+            sock = self.login()
+            try:
+                self.assertEqual(set(self.mlsd(sock, "bigdir")), names)
+
+                conn = socket.create_connection(
+                    ("127.0.0.1", self.epsv(sock)), timeout=5)
+                self.ftp_send(sock, "LIST bigdir")
+                self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 150)
+                lines = self.read_all(conn).decode().split("\r\n")
+                conn.close()
+                self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 226)
+                self.assertEqual({line.split()[-1] for line in lines if line},
+                                 names)
+            finally:
+                sock.close()
+        finally:
+            shutil.rmtree(big)
+
+
+class TestFtpdRateLimit(FtpdTestCase):
+    """Test the per-client transfer rate limit."""
+
+    SERVER_PORT = 21523
+    SERVER_ARGS = ["--rate-limit", "200K"]
+
+    def test_retr_limited(self):
+        """Test a RETR takes as long as its size at the limit."""
+        data = os.urandom(400 * 1024)
+        (Path(self.test_root) / "rate.bin").write_bytes(data)
+        sock = self.login()
+        try:
+            conn = socket.create_connection(("127.0.0.1", self.epsv(sock)),
+                                            timeout=5)
+            start = time.monotonic()
+            self.ftp_send(sock, "RETR rate.bin")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 150)
+            self.assertEqual(self.read_all(conn), data)
+            elapsed = time.monotonic() - start
+            conn.close()
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 226)
+            self.assertGreater(elapsed, 1.5)
+        finally:
+            sock.close()
+
+
+class TestFtpdScheduler(FtpdTestCase):
+    """Test that bulk transfers queue while small ones go ahead."""
+
+    SERVER_PORT = 21524
+    SERVER_ARGS = ["--max-transfers", "2", "--rate-limit", "64K",
+                   "--small-file", "4096"]
+
+    def start_retr(self, name):
+        """Log in and send RETR, returning the control and data sockets."""
+        sock = self.login()
+        conn = socket.create_connection(("127.0.0.1", self.epsv(sock)),
+                                        timeout=5)
+        self.ftp_send(sock, f"RETR {name}")
+        return sock, conn
+
+    def test_small_file_passes_queued_bulk(self):
+        """Test a small RETR is served while a bulk one waits."""
+        (Path(self.test_root) / "bulk.bin").write_bytes(b"x" * 1024 * 1024)
+        a_sock, a_conn = self.start_retr("bulk.bin")
+        b_sock = b_conn = None
+        try:
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(a_sock)), 150)
+            a_conn.recv(4096)
+
+            # Only one bulk transfer may run; B waits for A
+            b_sock, b_conn = self.start_retr("bulk.bin")
+            b_sock.settimeout(0.5)
+            with self.assertRaises(socket.timeout):
+                b_sock.recv(1024)
+
+            # A small file does not wait behind B
+            c_sock, c_conn = self.start_retr("testfile.txt")
+            try:
+                self.assertEqual(self.ftp_get_code(self.ftp_recv(c_sock)),
+                                 150)
+                self.assertEqual(self.read_all(c_conn), b"Hello, FTP!\n")
+                self.assertEqual(self.ftp_get_code(self.ftp_recv(c_sock)),
+                                 226)
+            finally:
+                c_conn.close()
+                c_sock.close()
+
+            # Once A is done, B starts
+            a_conn.close()
+            b_sock.settimeout(5)
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(b_sock)), 150)
+        finally:
+            a_conn.close()
+            a_sock.close()
+            if b_conn:
+                b_conn.close()
+                b_sock.close()
+
+
+class TestFtpdStats(FtpdTestCase):
+    """Test the stats endpoint and SITE STATS."""
+
+    SERVER_PORT = 21525
+    STATS_PORT = 21526
+    SERVER_ARGS = ["--stats-port", str(STATS_PORT)]
+
+    def http_get(self, path):
+        """GET a path from the stats endpoint, returning status and body."""
+        with socket.create_connection(("127.0.0.1", self.STATS_PORT),
+                                      timeout=5) as conn:
+            conn.sendall(f"GET {path} HTTP/1.0\r\n\r\n".encode())
+            response = self.read_all(conn).decode()
+        head, _, body = response.partition("\r\n\r\n")
+        return int(head.split()[1]), body
+
+    def retr_testfile(self, sock):
+        """Download testfile.txt over EPSV."""
+        conn = socket.create_connection(("127.0.0.1", self.epsv(sock)),
+                                        timeout=5)
+        self.ftp_send(sock, "RETR testfile.txt")
+        self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 150)
+        self.assertEqual(self.read_all(conn), b"Hello, FTP!\n")
+        conn.close()
+        self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 226)
+
+    def test_site_stats(self):
+        """Test SITE STATS reports a download and error replies."""
+        sock = self.login()
+        try:
+            self.retr_testfile(sock)
+            self.ftp_send(sock, "SIZE missing.txt")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 550)
+
+            self.ftp_send(sock, "SITE STATS")
+            data = b""
+            while not data.endswith(b"211 End.\r\n"):
+                chunk = sock.recv(4096)
+                self.assertTrue(chunk)
+                data += chunk
+            lines = data.decode().split("\r\n")
+            self.assertTrue(lines[0].startswith("211-"))
+            stats = json.loads(lines[1])
+            self.assertGreaterEqual(stats["sessions"], 1)
+            self.assertGreaterEqual(stats["bytes_out"], 12)
+            self.assertGreaterEqual(stats["commands"]["RETR"]["count"], 1)
+            self.assertGreaterEqual(stats["download"]["count"], 1)
+            self.assertGreaterEqual(stats["errors"]["550"], 1)
+
+            self.ftp_send(sock, "SITE CHMOD 644 testfile.txt")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 504)
+        finally:
+            sock.close()
+
+    def test_metrics(self):
+        """Test /metrics serves histograms in the Prometheus format."""
+        sock = self.login()
+        try:
+            self.retr_testfile(sock)
+        finally:
+            sock.close()
+
+        status, body = self.http_get("/metrics")
+        self.assertEqual(status, 200)
+        self.assertIn("# TYPE ftpd_command_duration_seconds histogram",
+                      body)
+        self.assertRegex(body, r'ftpd_command_duration_seconds_bucket'
+                               r'\{command="RETR",le="\+Inf"\} [1-9]')
+        self.assertRegex(body, r'ftpd_data_bytes_total\{direction="out"\} '
+                               r'[1-9]')
+        self.assertRegex(body, r"ftpd_connections_total [1-9]")
+
+    def test_session_churn(self):
+        """Test sessions are counted back down after many reconnects."""
+        for _ in range(3):
+            socks = [self.ftp_connect() for _ in range(100)]
+            for sock in socks:
+                self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 220)
+            for sock in socks:
+                sock.close()
+
+        deadline = time.monotonic() + 5
+        while True:
+            _, body = self.http_get("/stats")
+            stats = json.loads(body)
+            if stats["sessions"] == 0 or time.monotonic() > deadline:
+                break
+            time.sleep(0.05)
+        self.assertEqual(stats["sessions"], 0)
+        self.assertGreaterEqual(stats["connections"], 300)
+
+    def test_stats_json_and_unknown_path(self):
+        """Test /stats serves JSON and other paths are not found."""
+        status, body = self.http_get("/stats")
+        self.assertEqual(status, 200)
+        self.assertIn("bytes_in_per_second", json.loads(body))
+
+        status, _ = self.http_get("/nothing")
+        self.assertEqual(status, 404)
+
+    def test_cache_shared_by_downloads(self):
+        """Test clients fetching one small file at once read it from
+        disk once, and a changed file is read again."""
+        path = Path(self.test_root) / f"hot_{os.getpid()}.bin"
+        data = os.urandom(200000)
+        path.write_bytes(data)
+
+        def counts():
+            stats = json.loads(self.http_get("/stats")[1])
+            return stats["cache_hits"], stats["cache_misses"]
+
+        def fetch(rest=None):
+            ftp = ftplib.FTP()
+            ftp.connect("127.0.0.1", self.SERVER_PORT, timeout=5)
+            try:
+                ftp.login("testuser")
+                out = io.BytesIO()
+                ftp.retrbinary(f"RETR {path.name}", out.write, rest=rest)
+                return out.getvalue()
+            finally:
+                ftp.close()
+
+        try:
+            hits, misses = counts()
+            with ThreadPoolExecutor(max_workers=16) as pool:
+                results = list(pool.map(lambda _: fetch(), range(16)))
+            self.assertTrue(all(r == data for r in results))
+            self.assertEqual(counts(), (hits + 15, misses + 1))
+
+            self.assertEqual(fetch(rest=150000), data[150000:])
+
+            path.write_bytes(b"changed\n")
+            self.assertEqual(fetch(), b"changed\n")
+            self.assertEqual(counts(), (hits + 16, misses + 2))
+        finally:
+            path.unlink()
+
+
+class ResumingFTP(ftplib.FTP_TLS):
+    """FTP_TLS whose data connections resume the control session."""
+
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+        self.reused = []
+
+    def ntransfercmd(self, cmd, rest=None):
+        conn, size = ftplib.FTP.ntransfercmd(self, cmd, rest)
+        if self._prot_p:
+            conn = self.context.wrap_socket(conn, server_hostname=self.host,
+                                            session=self.sock.session)
+            self.reused.append(conn.session_reused)
+        return conn, size
+
+
+class TestFtpdTls(FtpdTestCase):
+    """Test AUTH TLS, PROT P and session resumption."""
+
+    SERVER_PORT = 21527
+
+    @classmethod
+    def setUpClass(cls):
+        """Make a self-signed certificate, then start the server with it."""
+        cls.cert_dir = tempfile.mkdtemp(prefix="ftpd_cert_")
+        cert = os.path.join(cls.cert_dir, "cert.pem")
+        key = os.path.join(cls.cert_dir, "key.pem")
+        try:
+            subprocess.run(
+                ["openssl", "req", "-x509", "-newkey", "ec",
+                 "-pkeyopt", "ec_paramgen_curve:prime256v1", "-nodes",
+                 "-keyout", key, "-out", cert, "-days", "1",
+                 "-subj", "/CN=localhost"],
+                check=True, capture_output=True)
+        except (OSError, subprocess.CalledProcessError):
+            shutil.rmtree(cls.cert_dir, ignore_errors=True)
+            raise unittest.SkipTest("openssl cannot make a certificate")
+        cls.SERVER_ARGS = ["--tls-cert", cert, "--tls-key", key]
+        super().setUpClass()
+
+    @classmethod
+    def tearDownClass(cls):
+        super().tearDownClass()
+        shutil.rmtree(cls.cert_dir, ignore_errors=True)
+
+    def tls_context(self):
+        """A client context that trusts the test certificate."""
+        context = ssl.create_default_context(
+            cafile=os.path.join(self.cert_dir, "cert.pem"))
+        context.check_hostname = False
+        return context
+
+    def tls_login(self, cls=ftplib.FTP_TLS, context=None, session=None):
+        """Log in over TLS with data protected."""
+        ftp = cls(context=context or self.tls_context(), timeout=5)
+        ftp.connect("127.0.0.1", self.SERVER_PORT)
+        if session is not None:
+            # ftplib has no way to resume; wrap the socket here instead
+            ftp.voidcmd("AUTH TLS")
+            ftp.sock = ftp.context.wrap_socket(ftp.sock, session=session)
+            ftp.file = ftp.sock.makefile("r", encoding=ftp.encoding)
+            ftp.login("testuser")
+        else:
+            ftp.login("testuser")
+        ftp.prot_p()
+        return ftp
+
+    def test_feat_lists_tls(self):
+        """Test FEAT advertises AUTH TLS, PBSZ and PROT."""
+        sock = self.ftp_connect()
+        try:
+            self.ftp_recv(sock)
+            self.ftp_send(sock, "FEAT")
+            data = b""
+            while b"211 End" not in data:
+                data += sock.recv(1024)
+            for feature in ("AUTH TLS", "PBSZ", "PROT"):
+                self.assertIn(f" {feature}\r\n", data.decode())
+        finally:
+            sock.close()
+
+    def test_protected_transfers(self):
+        """Test downloads, uploads and listings over protected data."""
+        ftp = self.tls_login()
+        try:
+            data = io.BytesIO()
+            ftp.retrbinary("RETR testfile.txt", data.write)
+            self.assertEqual(data.getvalue(), b"Hello, FTP!\n")
+
+            payload = os.urandom(300 * 1024)
+            ftp.storbinary("STOR tls_upload.bin", io.BytesIO(payload))
+            self.assertEqual(
+                (Path(self.test_root) / "tls_upload.bin").read_bytes(),
+                payload)
+
+            data = io.BytesIO()
+            ftp.retrbinary("RETR tls_upload.bin", data.write, rest=1000)
+            self.assertEqual(data.getvalue(), payload[1000:])
+
+            lines = []
+            ftp.retrlines("LIST", lines.append)
+            self.assertTrue(any("testfile.txt" in line for line in lines))
+            ftp.quit()
+        finally:
+            ftp.close()
+            (Path(self.test_root) / "tls_upload.bin").unlink(missing_ok=True)
+
+    def test_clear_data(self):
+        """Test PROT C leaves the data connection clear."""
+        ftp = self.tls_login()
+        try:
+            ftp.prot_c()
+            data = io.BytesIO()
+            ftp.retrbinary("RETR testfile.txt", data.write)
+            self.assertEqual(data.getvalue(), b"Hello, FTP!\n")
+        finally:
+            ftp.close()
+
+    def test_data_session_resumed(self):
+        """Test data connections resume the control connection's session."""
+        ftp = self.tls_login(ResumingFTP)
+        try:
+            for _ in range(2):
+                data = io.BytesIO()
+                ftp.retrbinary("RETR testfile.txt", data.write)
+                self.assertEqual(data.getvalue(), b"Hello, FTP!\n")
+            self.assertEqual(ftp.reused, [True, True])
+        finally:
+            ftp.close()
+
+    def test_reconnect_resumed(self):
+        """Test a new control connection resumes an earlier session."""
+        context = self.tls_context()
+        first = self.tls_login(context=context)
+        try:
+            first.pwd()
+            session = first.sock.session
+        finally:
+            first.close()
+
+        second = self.tls_login(context=context, session=session)
+        try:
+            self.assertTrue(second.sock.session_reused)
+            self.assertEqual(second.pwd(), "/")
+        finally:
+            second.close()
+
+    def test_clear_commands_after_auth_dropped(self):
+        """Test commands sent in the clear behind AUTH TLS are ignored."""
+        sock = self.ftp_connect()
+        try:
+            self.ftp_recv(sock)
+            self.ftp_send(sock, "AUTH TLS\r\nUSER intruder")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 234)
+            tls = self.tls_context().wrap_socket(sock)
+            self.ftp_send(tls, "PWD")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(tls)), 530)
+            tls.close()
+        finally:
+            sock.close()
+
+    def test_prot_needs_pbsz(self):
+        """Test PROT before PBSZ and unknown levels are refused."""
+        ftp = ftplib.FTP_TLS(context=self.tls_context(), timeout=5)
+        try:
+            ftp.connect("127.0.0.1", self.SERVER_PORT)
+            ftp.auth()
+            with self.assertRaises(ftplib.error_perm) as cm:
+                ftp.voidcmd("PROT P")
+            self.assertTrue(str(cm.exception).startswith("503"))
+            ftp.voidcmd("PBSZ 0")
+            with self.assertRaises(ftplib.error_perm) as cm:
+                ftp.voidcmd("PROT S")
+            self.assertTrue(str(cm.exception).startswith("536"))
+        finally:
+            ftp.close()
+
 
 class TestFtpdMkd(FtpdTestCase):
     """Test MKD command."""
@@ -496,6 +1361,321 @@ class TestFtpdMkd(FtpdTestCase):
             sock.close()
 
 
+class TestFtpdRemove(FtpdTestCase):
+    """Test DELE, RMD, and HASH, XSHA256 and XCRC, as used to mirror a
+    tree."""
+
+    def test_hash(self):
+        """Test HASH gives the SHA-256 of a file."""
+        sock = self.login()
+        try:
+            self.ftp_send(sock, "HASH testfile.txt")
+            self.assertEqual(
+                self.ftp_recv(sock),
+                "213 SHA-256 0-12 "
+                + hashlib.sha256(b"Hello, FTP!\n").hexdigest()
+                + " testfile.txt")
+
+            self.ftp_send(sock, "HASH subdir")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 550)
+
+            self.ftp_send(sock, "XSHA256 testfile.txt")
+            self.assertEqual(
+                self.ftp_recv(sock),
+                "250 " + hashlib.sha256(b"Hello, FTP!\n").hexdigest())
+            self.ftp_send(sock, "XCRC testfile.txt")
+            self.assertEqual(self.ftp_recv(sock),
+                             "250 %08x" % zlib.crc32(b"Hello, FTP!\n"))
+        finally:
+            sock.close()
+
+    def test_hash_cached(self):
+        """Test a digest is cached with the file until the file changes."""
+        path = Path(self.test_root) / f"cached_{os.getpid()}.txt"
+        path.write_text("first\n")
+        sock = self.login()
+        try:
+            self.ftp_send(sock, f"XCRC {path.name}")
+            self.assertEqual(self.ftp_recv(sock),
+                             "250 %08x" % zlib.crc32(b"first\n"))
+            try:
+                cached = os.getxattr(path, "user.ftpd.digest")
+            except OSError:
+                self.skipTest("no user extended attributes here")
+            self.assertIn(hashlib.sha256(b"first\n").hexdigest().encode(),
+                          cached)
+
+            path.write_text("second\n")
+            self.ftp_send(sock, f"XCRC {path.name}")
+            self.assertEqual(self.ftp_recv(sock),
+                             "250 %08x" % zlib.crc32(b"second\n"))
+        finally:
+            sock.close()
+            path.unlink()
+
+    def test_dele_and_rmd(self):
+        """Test DELE removes a file and RMD an empty directory."""
+        gone = Path(self.test_root) / f"gone_{os.getpid()}"
+        gone.mkdir()
+        (gone / "file.txt").write_text("x\n")
+        sock = self.login()
+        try:
+            self.ftp_send(sock, f"RMD {gone.name}")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 550)
+
+            self.ftp_send(sock, f"DELE {gone.name}/file.txt")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 250)
+            self.ftp_send(sock, f"RMD {gone.name}")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 250)
+            self.assertFalse(gone.exists())
+
+            self.ftp_send(sock, "DELE ../outside.txt")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 553)
+        finally:
+            sock.close()
+            shutil.rmtree(gone, ignore_errors=True)
+
+
+class TestFtpdDigestUploads(FtpdTestCase):
+    """Test uploads digested as they arrive."""
+
+    SERVER_PORT = 21528
+    SERVER_ARGS = ["--digest-uploads"]
+
+    def test_stor_caches_digest(self):
+        """Test STOR leaves the digest cached, and APPE does not."""
+        data = os.urandom(300000)
+        path = Path(self.test_root) / "digested.bin"
+        ftp = ftplib.FTP()
+        ftp.connect("127.0.0.1", self.SERVER_PORT, timeout=5)
+        try:
+            ftp.login("testuser")
+            ftp.storbinary("STOR digested.bin", io.BytesIO(data))
+            try:
+                cached = os.getxattr(path, "user.ftpd.digest")
+            except OSError:
+                self.skipTest("no user extended attributes here")
+            self.assertIn(hashlib.sha256(data).hexdigest().encode(), cached)
+            self.assertIn(hashlib.sha256(data).hexdigest(),
+                          ftp.sendcmd("HASH digested.bin"))
+
+            ftp.storbinary("APPE digested.bin", io.BytesIO(b"more"))
+            self.assertEqual(ftp.sendcmd("XCRC digested.bin"),
+                             "250 %08x" % zlib.crc32(data + b"more"))
+        finally:
+            ftp.close()
+            path.unlink(missing_ok=True)
+
+
+class TestFtpdModeZ(FtpdTestCase):
+    """Test MODE Z, data deflated on the data connection."""
+
+    def transfer(self, sock, command, send=None):
+        """Run a transfer over EPSV, returning what the server sent and
+        its final reply code."""
+        port = self.epsv(sock)
+        conn = socket.create_connection(("127.0.0.1", port), timeout=5)
+        self.ftp_send(sock, command)
+        self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 150)
+        data = b""
+        if send is None:
+            data = self.read_all(conn)
+        else:
+            conn.sendall(send)
+        conn.close()
+        return data, self.ftp_get_code(self.ftp_recv(sock))
+
+    def test_mode_and_opts(self):
+        """Test MODE S and Z are taken, others refused, and OPTS sets the
+        level."""
+        sock = self.login()
+        try:
+            self.ftp_send(sock, "MODE B")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 504)
+            self.ftp_send(sock, "MODE ZZ")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 501)
+            self.ftp_send(sock, "MODE z")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 200)
+            self.ftp_send(sock, "OPTS MODE Z LEVEL 9")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 200)
+            self.ftp_send(sock, "OPTS MODE Z LEVEL 10")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 501)
+            self.ftp_send(sock, "MODE S")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 200)
+        finally:
+            sock.close()
+
+    def test_retr_deflated(self):
+        """Test RETR in MODE Z sends one zlib stream, for small, large
+        and already compressed files."""
+        big = Path(self.test_root) / "big_z.txt"
+        big.write_bytes(b"".join(b"line %d of a compressible file\n" % i
+                                 for i in range(300000)))
+        packed = Path(self.test_root) / "packed_z.gz"
+        packed.write_bytes(os.urandom(200000))
+        sock = self.login()
+        try:
+            self.ftp_send(sock, "MODE Z")
+            self.ftp_recv(sock)
+
+            data, code = self.transfer(sock, "RETR testfile.txt")
+            self.assertEqual(code, 226)
+            self.assertEqual(zlib.decompress(data), b"Hello, FTP!\n")
+
+            data, code = self.transfer(sock, f"RETR {big.name}")
+            self.assertEqual(code, 226)
+            self.assertLess(len(data), big.stat().st_size // 4)
+            self.assertEqual(zlib.decompress(data), big.read_bytes())
+
+            # Stored rather than deflated again
+            data, code = self.transfer(sock, f"RETR {packed.name}")
+            self.assertEqual(code, 226)
+            self.assertEqual(zlib.decompress(data), packed.read_bytes())
+
+            self.ftp_send(sock, "REST 7")
+            self.ftp_recv(sock)
+            data, code = self.transfer(sock, "RETR testfile.txt")
+            self.assertEqual(zlib.decompress(data), b"FTP!\n")
+        finally:
+            sock.close()
+            big.unlink()
+            packed.unlink()
+
+    def test_list_deflated(self):
+        """Test listings in MODE Z, an empty one still a whole stream."""
+        empty = Path(self.test_root) / "empty_z"
+        empty.mkdir()
+        sock = self.login()
+        try:
+            self.ftp_send(sock, "MODE Z")
+            self.ftp_recv(sock)
+            data, code = self.transfer(sock, "LIST")
+            self.assertEqual(code, 226)
+            self.assertIn(b"testfile.txt", zlib.decompress(data))
+
+            data, code = self.transfer(sock, f"MLSD {empty.name}")
+            self.assertEqual(code, 226)
+            self.assertEqual(zlib.decompress(data), b"")
+        finally:
+            sock.close()
+            empty.rmdir()
+
+    def test_stor_inflated(self):
+        """Test STOR in MODE Z inflates, and a stream cut short fails."""
+        payload = os.urandom(100000) + b"text " * 100000
+        path = Path(self.test_root) / "stored_z.bin"
+        sock = self.login()
+        try:
+            self.ftp_send(sock, "MODE Z")
+            self.ftp_recv(sock)
+            stream = zlib.compress(payload)
+            _, code = self.transfer(sock, f"STOR {path.name}", stream)
+            self.assertEqual(code, 226)
+            self.assertEqual(path.read_bytes(), payload)
+
+            _, code = self.transfer(sock, f"STOR {path.name}",
+                                    stream[:len(stream) // 2])
+            self.assertEqual(code, 426)
+        finally:
+            sock.close()
+            path.unlink(missing_ok=True)
+
+
+class TestFtpdHandoff(FtpdTestCase):
+    """Test handing the listeners over to a new server."""
+
+    SERVER_PORT = 21531
+    STATS_PORT = 21532
+
+    @classmethod
+    def setUpClass(cls):
+        """Start the first server with a handoff socket."""
+        cls.handoff_dir = tempfile.mkdtemp(prefix="ftpd_handoff_")
+        cls.handoff_path = os.path.join(cls.handoff_dir, "ftpd.sock")
+        cls.SERVER_ARGS = ["--handoff", cls.handoff_path,
+                           "--drain-timeout", "2",
+                           "--stats-port", str(cls.STATS_PORT)]
+        super().setUpClass()
+
+    @classmethod
+    def tearDownClass(cls):
+        super().tearDownClass()
+        shutil.rmtree(cls.handoff_dir, ignore_errors=True)
+
+    def replace_server(self):
+        """Start a new server taking over from the running one."""
+        old = self.server_proc
+        new = subprocess.Popen(
+            [str(self.FTPD_BIN), "-p", str(self.SERVER_PORT),
+             "-r", self.test_root, *self.SERVER_ARGS],
+            stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+        type(self).server_proc = new
+        time.sleep(0.5)
+        if new.poll() is not None:
+            self.fail(new.stderr.read().decode())
+        return old
+
+    def test_sessions_survive_handoff(self):
+        """Test a session of the old server goes on, and new clients
+        reach the new one."""
+        sock = self.login()
+        try:
+            old = self.replace_server()
+            self.assertIsNone(old.poll())
+
+            # The old server still serves its session
+            self.ftp_send(sock, "PWD")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 257)
+
+            # New clients and the stats endpoint reach the new server
+            for _ in range(8):
+                with self.ftp_connect() as conn:
+                    self.assertEqual(
+                        self.ftp_get_code(self.ftp_recv(conn)), 220)
+            with socket.create_connection(("127.0.0.1", self.STATS_PORT),
+                                          timeout=5) as conn:
+                conn.sendall(b"GET /stats HTTP/1.0\r\n\r\n")
+                response = self.read_all(conn).decode()
+            self.assertIn("200", response.split("\r\n")[0])
+
+            # The old server ends once its last client has gone
+            self.ftp_send(sock, "QUIT")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 221)
+        finally:
+            sock.close()
+        old.communicate(timeout=5)
+        self.assertEqual(old.returncode, 0)
+
+    def test_drain_deadline(self):
+        """Test idle sessions are told to reconnect at the deadline."""
+        sock = self.login()
+        try:
+            old = self.replace_server()
+            start = time.monotonic()
+            sock.settimeout(5)
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 421)
+            self.assertGreaterEqual(time.monotonic() - start, 1)
+        finally:
+            sock.close()
+        old.communicate(timeout=5)
+        self.assertEqual(old.returncode, 0)
+        with self.ftp_connect() as conn:
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(conn)), 220)
+
+    def test_failed_successor(self):
+        """Test the old server goes on if the new one cannot start."""
+        new = subprocess.Popen(
+            [str(self.FTPD_BIN), "-p", str(self.SERVER_PORT + 100),
+             "-r", self.test_root, *self.SERVER_ARGS],
+            stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+        _, stderr = new.communicate(timeout=5)
+        self.assertNotEqual(new.returncode, 0)
+        self.assertIn(b"port", stderr)
+        self.assertIsNone(self.server_proc.poll())
+        with self.ftp_connect() as conn:
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(conn)), 220)
+
+
 class TestFtpdSecurity(FtpdTestCase):
     """Test path traversal security."""
 
@@ -546,6 +1726,64 @@ class TestFtpdSecurity(FtpdTestCase):
             sock.close()
 
 
+    def test_symlink_out_of_root(self):
+        """Test symlinks leading out of the root are refused."""
+        root = Path(self.test_root)
+        outside = Path(tempfile.mkdtemp(prefix="ftpd_outside_"))
+        (outside / "secret.txt").write_text("secret\n")
+        (root / "escape").symlink_to(outside)
+        (root / "escape.txt").symlink_to(outside / "secret.txt")
+        sock = self.login()
+        try:
+            for command in ("RETR escape.txt", "RETR escape/secret.txt",
+                            "STOR escape/new.txt"):
+                self.epsv(sock)
+                self.ftp_send(sock, command)
+                self.assertIn(self.ftp_get_code(self.ftp_recv(sock)),
+                              [550, 553], command)
+            self.ftp_send(sock, "CWD escape")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 550)
+            self.ftp_send(sock, "MKD escape/newdir")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 553)
+            self.assertEqual(sorted(os.listdir(outside)), ["secret.txt"])
+        finally:
+            sock.close()
+            (root / "escape").unlink()
+            (root / "escape.txt").unlink()
+            shutil.rmtree(outside, ignore_errors=True)
+
+    def test_symlink_within_root(self):
+        """Test symlinks within the root work from any directory."""
+        root = Path(self.test_root)
+        (root / "subdir" / "up.txt").symlink_to("../testfile.txt")
+        (root / "linkdir").symlink_to("subdir")
+        sock = self.login()
+        try:
+            self.ftp_send(sock, "CWD subdir")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 250)
+            conn = socket.create_connection(("127.0.0.1", self.epsv(sock)),
+                                            timeout=5)
+            self.ftp_send(sock, "RETR up.txt")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 150)
+            self.assertEqual(self.read_all(conn), b"Hello, FTP!\n")
+            conn.close()
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 226)
+
+            # The cwd is where the link leads, so .. is its parent
+            self.ftp_send(sock, "CWD /linkdir")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 250)
+            self.ftp_send(sock, "PWD")
+            self.assertIn('"/subdir"', self.ftp_recv(sock))
+            self.ftp_send(sock, "CWD ../subdir/..")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 250)
+            self.ftp_send(sock, "PWD")
+            self.assertIn('"/"', self.ftp_recv(sock))
+        finally:
+            sock.close()
+            (root / "subdir" / "up.txt").unlink()
+            (root / "linkdir").unlink()
+
+
 class TestFtpdMultipleClients(FtpdTestCase):
     """Test multiple simultaneous clients."""
 
@@ -573,6 +1811,104 @@ class TestFtpdMultipleClients(FtpdTestCase):
             sock1.close()
             sock2.close()
 
+    def test_many_idle_clients(self):
+        """Test many idle sessions are served at once."""
+        socks = []
+        try:
+            for _ in range(200):
+                socks.append(self.ftp_connect())
+            for sock in socks:
+                self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 220)
+            for sock in socks:
+                self.ftp_send(sock, "NOOP")
+            for sock in socks:
+                self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 200)
+        finally:
+            for sock in socks:
+                sock.close()
+
+    def test_stalled_transfer_does_not_block_others(self):
+        """Test a transfer waiting on its client leaves others served."""
+        big = Path(self.test_root) / "big.bin"
+        big.write_bytes(b"x" * (16 * 1024 * 1024))
+        sock1 = self.ftp_connect()
+        sock2 = self.ftp_connect()
+        data_sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+
+        try:
+            data_sock.bind(("127.0.0.1", 0))
+            data_sock.listen(1)
+            data_sock.settimeout(5)
+            port = data_sock.getsockname()[1]
+
+            self.ftp_recv(sock1)
+            self.ftp_send(sock1, "USER user1")
+            self.ftp_recv(sock1)
+            self.ftp_send(sock1, f"PORT 127,0,0,1,{port >> 8},{port & 0xFF}")
+            self.ftp_recv(sock1)
+
+            # The NOOP waits behind the transfer, which waits on the reader
+            sock1.send(b"RETR big.bin\r\nNOOP\r\n")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock1)), 150)
+            conn, _ = data_sock.accept()
+            conn.settimeout(5)
+
+            self.ftp_recv(sock2)
+            self.ftp_send(sock2, "NOOP")
+            self.assertEqual(self.ftp_get_code(self.ftp_recv(sock2)), 200)
+
+            received = 0
+            while True:
+                chunk = conn.recv(65536)
+                if not chunk:
+                    break
+                received += len(chunk)
+            conn.close()
+            self.assertEqual(received, big.stat().st_size)
+
+            replies = b""
+            while replies.count(b"\r\n") < 2:
+                chunk = sock1.recv(1024)
+                if not chunk:
+                    break
+                replies += chunk
+            codes = [self.ftp_get_code(line) for line in
+                     replies.decode().split("\r\n") if line]
+            self.assertEqual(codes, [226, 200])
+        finally:
+            data_sock.close()
+            sock1.close()
+            sock2.close()
+            big.unlink(missing_ok=True)
+
+
+
+class TestFtpdAcceptors(TestFtpdMultipleClients):
+    """Test multiple clients over several event loops."""
+
+    SERVER_PORT = 21529
+    STATS_PORT = 21530
+    SERVER_ARGS = ["--acceptors", "4", "--stats-port", str(STATS_PORT)]
+
+    def test_sessions_counted_over_loops(self):
+        """Test the session count sums the clients of every loop."""
+        socks = []
+        try:
+            for _ in range(32):
+                socks.append(self.ftp_connect())
+            for sock in socks:
+                self.assertEqual(self.ftp_get_code(self.ftp_recv(sock)), 220)
+            with socket.create_connection(("127.0.0.1", self.STATS_PORT),
+                                          timeout=5) as conn:
+                conn.sendall(b"GET /stats HTTP/1.0\r\n\r\n")
+                response = self.read_all(conn).decode()
+            stats = json.loads(response.partition("\r\n\r\n")[2])
+            self.assertGreaterEqual(stats["sessions"], 32)
+            self.assertGreaterEqual(stats["connections"], 32)
+        finally:
+            for sock in socks:
+                sock.close()
+
 
 if __name__ == "__main__":
     unittest.main()
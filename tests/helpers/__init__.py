@@ -1,6 +1,7 @@
 """Test helpers for jbox tests."""
 
 from .jshell import JShellRunner
+from .mock_gemini import MockGeminiServer
 from .signals import SignalTestHelper
 
-__all__ = ["JShellRunner", "SignalTestHelper"]
+__all__ = ["JShellRunner", "MockGeminiServer", "SignalTestHelper"]
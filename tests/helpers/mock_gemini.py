@@ -0,0 +1,85 @@
+"""Helper module serving a local fake of the Gemini API for tests."""
+
+import json
+import threading
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+class MockGeminiServer:
+    """Fake Gemini API answering every generate request with one command.
+
+    Point jshell at it with the env() variables. Uploads of cached content
+    are refused, so queries carry their context inline, as they do when
+    the real API will not cache it.
+    """
+
+    def __init__(self, answer: str = "echo mocked"):
+        """Start serving on a free local port.
+
+        Args:
+            answer: Text of every generated response
+        """
+        self.answer = answer
+        self.queries = []
+        self._lock = threading.Lock()
+        self._server = ThreadingHTTPServer(("127.0.0.1", 0),
+                                           self._handler())
+        self._thread = threading.Thread(target=self._server.serve_forever,
+                                        daemon=True)
+        self._thread.start()
+
+    @property
+    def url(self) -> str:
+        """Root URL of the fake API, ending with a slash."""
+        host, port = self._server.server_address
+        return f"http://{host}:{port}/"
+
+    def env(self) -> dict:
+        """Return the environment that sends jshell's AI queries here."""
+        return {"JSHELL_GEMINI_API": self.url, "GOOGLE_API_KEY": "test-key"}
+
+    @property
+    def requests(self) -> int:
+        """Number of generate requests received."""
+        with self._lock:
+            return len(self.queries)
+
+    def close(self):
+        """Stop serving."""
+        self._server.shutdown()
+        self._server.server_close()
+        self._thread.join()
+
+    def _handler(self):
+        """Return the request handler class bound to this server."""
+        mock = self
+
+        class Handler(BaseHTTPRequestHandler):
+            def log_message(self, *args):
+                pass
+
+            def do_POST(self):
+                length = int(self.headers.get("Content-Length", 0))
+                body = self.rfile.read(length)
+                if ":streamGenerateContent" not in self.path:
+                    self._reply(400, "application/json", json.dumps(
+                        {"error": {"code": 400, "message": "not cached"}}))
+                    return
+                request = json.loads(body)
+                query = request["contents"][-1]["parts"][-1]["text"]
+                with mock._lock:
+                    mock.queries.append(query)
+                chunk = {"candidates": [{"content": {
+                    "parts": [{"text": mock.answer}], "role": "model"}}]}
+                self._reply(200, "text/event-stream",
+                            f"data: {json.dumps(chunk)}\r\n\r\n")
+
+            def _reply(self, status, content_type, text):
+                data = text.encode()
+                self.send_response(status)
+                self.send_header("Content-Type", content_type)
+                self.send_header("Content-Length", str(len(data)))
+                self.end_headers()
+                self.wfile.write(data)
+
+        return Handler
@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+"""Unit tests for the date builtin."""
+
+import json
+import unittest
+
+from tests.helpers import JShellRunner
+
+
+class TestDateBuiltin(unittest.TestCase):
+    """Test cases for the date builtin."""
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the jshell binary exists before running tests."""
+        if not JShellRunner.exists():
+            raise unittest.SkipTest(
+                f"jshell binary not found at {JShellRunner.JSHELL}")
+
+    def test_help(self):
+        """Test --help flag shows help."""
+        result = JShellRunner.run("date --help")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("Usage: date", result.stdout)
+
+    def test_is_builtin(self):
+        """Test the shell's date is the builtin, not the linked app."""
+        result = JShellRunner.run("type date")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("date is a shell builtin", result.stdout)
+
+    def test_format(self):
+        """Test the default format matches the date app."""
+        result = JShellRunner.run("date", env={"TZ": "UTC"})
+        self.assertEqual(result.returncode, 0)
+        self.assertRegex(
+            result.stdout.strip(),
+            r"^\w{3} \w{3} [ \d]\d \d{2}:\d{2}:\d{2} UTC \d{4}$")
+
+    def test_time_zone_change(self):
+        """Test a TZ exported after the first date is picked up."""
+        result = JShellRunner.run("date; export TZ=UTC; date",
+                                  env={"TZ": "Asia/Tokyo"})
+        self.assertEqual(result.returncode, 0)
+        lines = result.stdout.splitlines()
+        self.assertEqual(len(lines), 2)
+        self.assertIn("JST", lines[0])
+        self.assertIn("UTC", lines[1])
+
+    def test_starts_no_process(self):
+        """Test date starts no child process."""
+        result = JShellRunner.run("stats -r > /dev/null; date; stats --json")
+        self.assertEqual(result.returncode, 0)
+        stats = json.loads(result.stdout.splitlines()[-1])
+        self.assertEqual(stats["spawns"] + stats["forks"], 0)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+"""Unit tests for the edit-apply builtin command."""
+
+import json
+import os
+import tempfile
+import unittest
+from pathlib import Path
+
+from tests.helpers import JShellRunner
+
+
+class TestEditApplyBuiltin(unittest.TestCase):
+    """Test cases for the edit-apply builtin command."""
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the jshell binary exists before running tests."""
+        if not JShellRunner.exists():
+            raise unittest.SkipTest(
+                f"jshell binary not found at {JShellRunner.JSHELL}")
+
+    def setUp(self):
+        self.tmpdir = tempfile.TemporaryDirectory()
+        self.dir = Path(self.tmpdir.name)
+
+    def tearDown(self):
+        self.tmpdir.cleanup()
+
+    def write_edits(self, edits, ndjson=False):
+        """Write a batch of edits and return its path."""
+        path = self.dir / "edits.json"
+        if ndjson:
+            path.write_text("".join(json.dumps(e) + "\n" for e in edits))
+        else:
+            path.write_text(json.dumps(edits))
+        return path
+
+    def test_help_short(self):
+        """Test -h flag shows help."""
+        result = JShellRunner.run("edit-apply -h")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("Usage: edit-apply", result.stdout)
+        self.assertIn("--json", result.stdout)
+
+    def test_line_numbers_refer_to_original(self):
+        """Test that edits by line number all see the original file."""
+        target = self.dir / "a.txt"
+        target.write_text("one\ntwo\nthree\nfour\n")
+        edits = self.write_edits([
+            {"file": str(target), "op": "delete", "line": 1},
+            {"file": str(target), "op": "replace", "line": 3,
+             "text": "THREE"},
+            {"file": str(target), "op": "insert", "line": 2, "text": "1.5"},
+            {"file": str(target), "op": "insert", "line": 5, "text": "five"},
+        ])
+
+        result = JShellRunner.run(f'edit-apply "{edits}"')
+        self.assertEqual(result.returncode, 0, result.stderr)
+        self.assertEqual(target.read_text(), "1.5\ntwo\nTHREE\nfour\nfive\n")
+
+    def test_match_and_ndjson(self):
+        """Test edits selecting lines by regex, given as NDJSON."""
+        target = self.dir / "a.txt"
+        target.write_text("# comment\ncode\n# Another\nmore\n")
+        edits = self.write_edits([
+            {"file": str(target), "op": "delete", "match": "^#"},
+            {"file": str(target), "op": "insert", "match": "^MORE$",
+             "ignore_case": True, "text": "before more"},
+        ], ndjson=True)
+
+        data = JShellRunner.run_json(f'edit-apply --json "{edits}"')
+        self.assertEqual(data["status"], "ok")
+        self.assertEqual([e["lines"] for e in data["edits"]], [2, 1])
+        self.assertEqual(target.read_text(), "code\nbefore more\nmore\n")
+
+    def test_many_files(self):
+        """Test a batch editing several files."""
+        a = self.dir / "a.txt"
+        b = self.dir / "b.txt"
+        a.write_text("a1\na2\n")
+        b.write_text("b1\nb2\n")
+        edits = self.write_edits([
+            {"file": str(b), "op": "replace", "line": 2, "text": "B2"},
+            {"file": str(a), "op": "replace", "line": 1, "text": "A1"},
+            {"file": str(b), "op": "delete", "line": 1},
+        ])
+
+        data = JShellRunner.run_json(f'edit-apply --json "{edits}"')
+        self.assertEqual(data["status"], "ok")
+        self.assertEqual([e["edit"] for e in data["edits"]], [1, 2, 3])
+        self.assertEqual(a.read_text(), "A1\na2\n")
+        self.assertEqual(b.read_text(), "B2\n")
+
+    def test_failed_edit_leaves_file_untouched(self):
+        """Test that one failing edit keeps its file, not the others."""
+        a = self.dir / "a.txt"
+        b = self.dir / "b.txt"
+        a.write_text("a1\na2\n")
+        b.write_text("b1\n")
+        edits = self.write_edits([
+            {"file": str(a), "op": "replace", "line": 1, "text": "A1"},
+            {"file": str(a), "op": "delete", "line": 9},
+            {"file": str(b), "op": "replace", "line": 1, "text": "B1"},
+        ])
+
+        result = JShellRunner.run(f'edit-apply --json "{edits}"')
+        self.assertEqual(result.returncode, 1)
+        data = json.loads(result.stdout)
+        self.assertEqual(data["status"], "error")
+        statuses = [e["status"] for e in data["edits"]]
+        self.assertEqual(statuses, ["skipped", "error", "ok"])
+        self.assertIn("exceeds file length", data["edits"][1]["message"])
+        self.assertEqual(a.read_text(), "a1\na2\n")
+        self.assertEqual(b.read_text(), "B1\n")
+        self.assertEqual(sorted(os.listdir(self.dir)),
+                         ["a.txt", "b.txt", "edits.json"])
+
+    def test_conflicting_edits(self):
+        """Test that two edits changing the same line are rejected."""
+        target = self.dir / "a.txt"
+        target.write_text("x\ny\n")
+        edits = self.write_edits([
+            {"file": str(target), "op": "replace", "line": 2, "text": "Y"},
+            {"file": str(target), "op": "delete", "match": "y"},
+        ])
+
+        result = JShellRunner.run(f'edit-apply "{edits}"')
+        self.assertEqual(result.returncode, 1)
+        self.assertIn("edit 2", result.stderr)
+        self.assertEqual(target.read_text(), "x\ny\n")
+
+    def test_invalid_batch(self):
+        """Test that a malformed edit stops the batch before any file."""
+        target = self.dir / "a.txt"
+        target.write_text("x\n")
+        edits = self.write_edits([
+            {"file": str(target), "op": "replace", "line": 1, "text": "X"},
+            {"file": str(target), "op": "move", "line": 1},
+        ])
+
+        data = JShellRunner.run_json(f'edit-apply --json "{edits}"')
+        self.assertEqual(data["status"], "error")
+        self.assertIn("edit 2", data["message"])
+        self.assertEqual(target.read_text(), "x\n")
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -226,6 +226,32 @@ class TestEditDeleteLineBuiltin(unittest.TestCase):
         finally:
             os.unlink(temp_path)
 
+    def test_large_file_line_index(self):
+        """Test edits of a large file go through a line index that follows
+        them."""
+        with tempfile.TemporaryDirectory() as home:
+            path = os.path.join(home, "big.txt")
+            lines = [f"line{i}" for i in range(1, 200001)]
+            Path(path).write_text("\n".join(lines) + "\n")
+            env = {"HOME": home}
+
+            for line_num in ("150000", "5", "150000"):
+                result = JShellRunner.run(
+                    f'edit-delete-line "{path}" "{line_num}"', env=env)
+                self.assertEqual(result.returncode, 0)
+                del lines[int(line_num) - 1]
+            self.assertEqual(Path(path).read_text(),
+                             "\n".join(lines) + "\n")
+
+            cache = os.path.join(home, ".jshell", "cache")
+            self.assertTrue(any(n.endswith(".jbli")
+                                for n in os.listdir(cache)))
+
+            result = JShellRunner.run(
+                f'edit-delete-line "{path}" "199998"', env=env)
+            self.assertEqual(result.returncode, 1)
+            self.assertIn("199997", result.stderr)
+
 
 if __name__ == "__main__":
     unittest.main()
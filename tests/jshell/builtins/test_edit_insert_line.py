@@ -241,5 +241,36 @@ class TestEditInsertLineBuiltin(unittest.TestCase):
             os.unlink(temp_path)
 
 
+    def test_failed_insert_leaves_no_temp_file(self):
+        """Test a line past the end leaves the directory as it was."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = Path(tmpdir) / "file.txt"
+            path.write_text("only\n")
+
+            result = JShellRunner.run(
+                f'edit-insert-line "{path}" "5" "text"')
+            self.assertNotEqual(result.returncode, 0)
+
+            self.assertEqual(path.read_text(), "only\n")
+            self.assertEqual(os.listdir(tmpdir), ["file.txt"])
+
+    def test_append_to_file_without_final_newline(self):
+        """Test appending after a last line that has no newline."""
+        with tempfile.NamedTemporaryFile(mode="w", delete=False,
+                                          suffix=".txt") as f:
+            f.write("first\nlast")
+            temp_path = f.name
+
+        try:
+            result = JShellRunner.run(
+                f'edit-insert-line "{temp_path}" "3" "appended"')
+            self.assertEqual(result.returncode, 0)
+
+            content = Path(temp_path).read_text()
+            self.assertEqual(content, "first\nlast\nappended\n")
+        finally:
+            os.unlink(temp_path)
+
+
 if __name__ == "__main__":
     unittest.main()
@@ -249,5 +249,109 @@ class TestEditReplaceBuiltin(unittest.TestCase):
             os.unlink(temp_path)
 
 
+    def test_no_matches_leaves_file_untouched(self):
+        """Test the file is not rewritten when nothing matches."""
+        with tempfile.NamedTemporaryFile(mode="w", delete=False,
+                                          suffix=".txt") as f:
+            f.write("hello world\n")
+            temp_path = f.name
+
+        try:
+            before = os.stat(temp_path)
+            result = JShellRunner.run(
+                f'edit-replace "{temp_path}" "xyz" "abc"')
+            self.assertEqual(result.returncode, 0)
+
+            after = os.stat(temp_path)
+            self.assertEqual(before.st_ino, after.st_ino)
+            self.assertEqual(before.st_mtime_ns, after.st_mtime_ns)
+        finally:
+            os.unlink(temp_path)
+
+    def test_count_only(self):
+        """Test --count-only counts matches and leaves the file alone."""
+        with tempfile.NamedTemporaryFile(mode="w", delete=False,
+                                          suffix=".txt") as f:
+            f.write("foo foo\nbar\nFOO\n")
+            temp_path = f.name
+
+        try:
+            before = os.stat(temp_path)
+            result = JShellRunner.run(
+                f'edit-replace --count-only -i --fixed-strings '
+                f'"{temp_path}" "foo" "x"')
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(result.stdout.strip(), "3")
+
+            after = os.stat(temp_path)
+            self.assertEqual(before.st_ino, after.st_ino)
+            self.assertEqual(Path(temp_path).read_text(),
+                             "foo foo\nbar\nFOO\n")
+        finally:
+            os.unlink(temp_path)
+
+    def test_max_replacements(self):
+        """Test --max-replacements stops after N replacements."""
+        with tempfile.NamedTemporaryFile(mode="w", delete=False,
+                                          suffix=".txt") as f:
+            f.write("a a\na\na\n")
+            temp_path = f.name
+
+        try:
+            data = JShellRunner.run_json(
+                f'edit-replace --json --max-replacements 3 '
+                f'"{temp_path}" "a" "b"')
+            self.assertEqual(data["replacements"], 3)
+            self.assertEqual(Path(temp_path).read_text(), "b b\nb\na\n")
+        finally:
+            os.unlink(temp_path)
+
+    def test_anchor_matches_once_per_line(self):
+        """Test ^ only matches at the start of the line."""
+        with tempfile.NamedTemporaryFile(mode="w", delete=False,
+                                          suffix=".txt") as f:
+            f.write("aaa\n")
+            temp_path = f.name
+
+        try:
+            result = JShellRunner.run(f'edit-replace "{temp_path}" "^a" "b"')
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(Path(temp_path).read_text(), "baa\n")
+        finally:
+            os.unlink(temp_path)
+
+    def test_many_files(self):
+        """Test --files edits every file and reports each one."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            paths = []
+            for i in range(20):
+                path = Path(tmpdir) / f"f{i}.txt"
+                path.write_text("old\n" * (i % 3) + "keep\n")
+                paths.append(path)
+            missing = Path(tmpdir) / "missing.txt"
+            names = " ".join(f'"{p}"' for p in paths + [missing])
+
+            result = JShellRunner.run(
+                f'edit-replace --json --files "old" "new" {names}')
+            self.assertEqual(result.returncode, 1)
+            data = json.loads(result.stdout)
+            self.assertEqual(data["status"], "error")
+            self.assertEqual(data["files"], 21)
+            self.assertEqual(data["replacements"],
+                             sum(i % 3 for i in range(20)))
+            self.assertEqual(data["results"][-1]["status"], "error")
+            for i, path in enumerate(paths):
+                self.assertEqual(data["results"][i]["path"], str(path))
+                self.assertEqual(data["results"][i]["replacements"], i % 3)
+                self.assertEqual(path.read_text(),
+                                 "new\n" * (i % 3) + "keep\n")
+
+    def test_too_many_arguments_without_files(self):
+        """Test that extra arguments need --files."""
+        result = JShellRunner.run('edit-replace a b c d')
+        self.assertEqual(result.returncode, 1)
+        self.assertIn("--files", result.stderr)
+
+
 if __name__ == "__main__":
     unittest.main()
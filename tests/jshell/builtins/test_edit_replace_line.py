@@ -223,5 +223,47 @@ class TestEditReplaceLineBuiltin(unittest.TestCase):
             os.unlink(temp_path)
 
 
+    def test_keeps_mode_and_symlink(self):
+        """Test the file behind a symlink is replaced with its mode kept."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            target = Path(tmpdir) / "target.txt"
+            target.write_text("line1\nline2\n")
+            target.chmod(0o640)
+            link = Path(tmpdir) / "link.txt"
+            link.symlink_to(target)
+
+            result = JShellRunner.run(
+                f'edit-replace-line "{link}" "2" "replaced"')
+            self.assertEqual(result.returncode, 0)
+
+            self.assertTrue(link.is_symlink())
+            self.assertEqual(target.read_text(), "line1\nreplaced\n")
+            self.assertEqual(target.stat().st_mode & 0o777, 0o640)
+            self.assertEqual(sorted(os.listdir(tmpdir)),
+                             ["link.txt", "target.txt"])
+
+    def test_large_file(self):
+        """Test a file much larger than the stream buffers."""
+        with tempfile.NamedTemporaryFile(mode="w", delete=False,
+                                          suffix=".txt") as f:
+            for i in range(200000):
+                f.write(f"line {i}\n")
+            temp_path = f.name
+
+        try:
+            result = JShellRunner.run(
+                f'edit-replace-line "{temp_path}" "100000" "middle"')
+            self.assertEqual(result.returncode, 0)
+
+            lines = Path(temp_path).read_text().split("\n")
+            self.assertEqual(len(lines), 200001)
+            self.assertEqual(lines[99998], "line 99998")
+            self.assertEqual(lines[99999], "middle")
+            self.assertEqual(lines[100000], "line 100000")
+            self.assertEqual(lines[199999], "line 199999")
+        finally:
+            os.unlink(temp_path)
+
+
 if __name__ == "__main__":
     unittest.main()
@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+"""Unit tests for the hash builtin command."""
+
+import json
+import os
+import stat
+import tempfile
+import unittest
+
+from tests.helpers import JShellRunner
+
+
+class TestHashBuiltin(unittest.TestCase):
+    """Test cases for the hash builtin and the PATH resolution cache."""
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the jshell binary exists before running tests."""
+        if not JShellRunner.exists():
+            raise unittest.SkipTest(
+                f"jshell binary not found at {JShellRunner.JSHELL}")
+
+    def setUp(self):
+        """Create a private PATH directory for test executables."""
+        self.temp_dir = tempfile.mkdtemp()
+        self.path_env = f"{self.temp_dir}:{os.environ.get('PATH', '')}"
+
+    def tearDown(self):
+        """Remove the private PATH directory."""
+        for name in os.listdir(self.temp_dir):
+            os.remove(os.path.join(self.temp_dir, name))
+        os.rmdir(self.temp_dir)
+
+    def _write_script(self, name, output):
+        """Create an executable shell script that prints output."""
+        path = os.path.join(self.temp_dir, name)
+        with open(path, "w") as f:
+            f.write(f"#!/bin/sh\necho {output}\n")
+        os.chmod(path, stat.S_IRWXU)
+        return path
+
+    def test_help_short(self):
+        """Test -h flag shows help."""
+        result = JShellRunner.run("hash -h")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("Usage: hash", result.stdout)
+        self.assertIn("--json", result.stdout)
+
+    def test_empty_table(self):
+        """Test hash reports an empty table in a fresh shell."""
+        result = JShellRunner.run("hash")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("hash table empty", result.stdout)
+
+    def test_external_command_is_remembered(self):
+        """Test running an external command records it with a hit count."""
+        path = self._write_script("_hash_test_cmd", "HASHED")
+        result = JShellRunner.run(
+            "_hash_test_cmd; _hash_test_cmd; hash --json",
+            env={"PATH": self.path_env})
+        self.assertEqual(result.returncode, 0)
+        json_start = result.stdout.index("[")
+        data = json.loads(result.stdout[json_start:])
+        entries = {e["name"]: e for e in data}
+        self.assertIn("_hash_test_cmd", entries)
+        self.assertEqual(entries["_hash_test_cmd"]["path"], path)
+        self.assertEqual(entries["_hash_test_cmd"]["hits"], 2)
+
+    def test_reset_forgets_entries(self):
+        """Test hash -r clears the table."""
+        self._write_script("_hash_test_cmd", "HASHED")
+        result = JShellRunner.run(
+            "_hash_test_cmd; hash -r; hash",
+            env={"PATH": self.path_env})
+        self.assertIn("hash table empty", result.stdout)
+
+    def test_name_argument_adds_entry(self):
+        """Test hash NAME resolves and remembers without running."""
+        self._write_script("_hash_test_cmd", "SHOULD_NOT_RUN")
+        result = JShellRunner.run(
+            "hash _hash_test_cmd; hash",
+            env={"PATH": self.path_env})
+        self.assertEqual(result.returncode, 0)
+        self.assertNotIn("SHOULD_NOT_RUN", result.stdout)
+        self.assertIn("_hash_test_cmd", result.stdout)
+
+    def test_name_not_found(self):
+        """Test hash NAME fails for unknown commands."""
+        result = JShellRunner.run("hash _nonexistent_command_xyz123")
+        self.assertNotEqual(result.returncode, 0)
+        self.assertIn("not found", result.stderr)
+
+    def test_new_command_earlier_in_path_shadows_cached(self):
+        """Test the cache is invalidated when an earlier PATH dir changes."""
+        later_dir = tempfile.mkdtemp()
+        try:
+            later = os.path.join(later_dir, "_hash_shadow_cmd")
+            with open(later, "w") as f:
+                f.write("#!/bin/sh\necho LATER\n")
+            os.chmod(later, stat.S_IRWXU)
+            source = os.path.join(later_dir, "earlier_src")
+            with open(source, "w") as f:
+                f.write("#!/bin/sh\necho EARLIER\n")
+            os.chmod(source, stat.S_IRWXU)
+            shadow = os.path.join(self.temp_dir, "_hash_shadow_cmd")
+            path_env = f"{self.temp_dir}:{later_dir}:{os.environ['PATH']}"
+
+            result = JShellRunner.run(
+                f"_hash_shadow_cmd; /bin/cp {source} {shadow}; "
+                "_hash_shadow_cmd",
+                env={"PATH": path_env})
+            self.assertEqual(result.stdout.split(), ["LATER", "EARLIER"])
+        finally:
+            for name in os.listdir(later_dir):
+                os.remove(os.path.join(later_dir, name))
+            os.rmdir(later_dir)
+
+
+if __name__ == "__main__":
+    unittest.main()
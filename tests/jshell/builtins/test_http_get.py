@@ -56,6 +56,39 @@ class TestHttpGetHelp(unittest.TestCase):
         self.assertIn("-H", result.stdout)
         self.assertIn("header", result.stdout.lower())
 
+    def test_help_shows_batch_option(self):
+        """Test that help mentions the --batch and --jobs options."""
+        result = JShellRunner.run("http-get -h", timeout=30)
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("--batch", result.stdout)
+        self.assertIn("--jobs", result.stdout)
+
+    def test_help_shows_cache_option(self):
+        """Test that help mentions the --cache option."""
+        result = JShellRunner.run("http-get -h", timeout=30)
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("--cache", result.stdout)
+        self.assertIn("http-cache", result.stdout)
+
+    def test_help_shows_output_option(self):
+        """Test that help mentions the -o output file option."""
+        result = JShellRunner.run("http-get -h", timeout=30)
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("--output", result.stdout)
+
+    def test_help_shows_segments_option(self):
+        """Test that help mentions the --segments option."""
+        result = JShellRunner.run("http-get -h", timeout=30)
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("--segments", result.stdout)
+
+    def test_segments_requires_output(self):
+        """Test that --segments is refused without -o FILE."""
+        result = JShellRunner.run(
+            "http-get --segments 4 http://localhost/", timeout=30)
+        self.assertNotEqual(result.returncode, 0)
+        self.assertIn("--segments", result.stderr)
+
     def test_help_shows_examples(self):
         """Test that help includes examples."""
         result = JShellRunner.run("http-get -h", timeout=30)
@@ -56,6 +56,20 @@ class TestHttpPostHelp(unittest.TestCase):
         self.assertIn("-H", result.stdout)
         self.assertIn("header", result.stdout.lower())
 
+    def test_help_shows_batch_option(self):
+        """Test that help mentions the --batch and --jobs options."""
+        result = JShellRunner.run("http-post -h", timeout=30)
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("--batch", result.stdout)
+        self.assertIn("--jobs", result.stdout)
+
+    def test_help_shows_streaming_options(self):
+        """Test that help mentions --data-file and --gzip."""
+        result = JShellRunner.run("http-post -h", timeout=30)
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("--data-file", result.stdout)
+        self.assertIn("--gzip", result.stdout)
+
     def test_help_shows_data_option(self):
         """Test that help mentions the -d data option."""
         result = JShellRunner.run("http-post -h", timeout=30)
@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+"""Unit tests for the jobs builtin and the output kept for background jobs."""
+
+import json
+import os
+import re
+import subprocess
+import unittest
+
+from tests.helpers import JShellRunner
+
+
+def run_session(lines, env=None, timeout=10):
+    """Feed lines to an interactive shell, where job output is kept."""
+    full_env = os.environ.copy()
+    if env:
+        full_env.update(env)
+    return subprocess.run(
+        [str(JShellRunner.JSHELL)],
+        input="\n".join(lines) + "\nexit\n",
+        capture_output=True,
+        text=True,
+        env=full_env,
+        timeout=timeout,
+    )
+
+
+class TestJobsBuiltin(unittest.TestCase):
+    """Test cases for the jobs builtin."""
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the jshell binary exists before running tests."""
+        if not JShellRunner.exists():
+            raise unittest.SkipTest(
+                f"jshell binary not found at {JShellRunner.JSHELL}")
+
+    def test_help(self):
+        """Test --help flag shows help."""
+        result = JShellRunner.run("jobs --help")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("Usage: jobs", result.stdout)
+        self.assertIn("--output", result.stdout)
+
+    def test_output_of_missing_job(self):
+        """Test --output for an unknown job is an error."""
+        result = JShellRunner.run("jobs --output 99")
+        self.assertNotEqual(result.returncode, 0)
+        self.assertIn("no such job", result.stderr)
+
+    def test_wait_prints_kept_output(self):
+        """Test output kept for a job is printed when wait collects it."""
+        result = run_session(["/bin/echo spooled &", "wait"])
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("spooled", result.stdout)
+
+    def test_output_json_while_running(self):
+        """Test --output --json reports a running job's kept output."""
+        result = run_session([
+            "/bin/sh -c 'echo early; sleep 2' &",
+            "/bin/sleep 0.5",
+            "jobs --output 1 --json",
+            "kill %1",
+        ])
+        match = re.search(r'\{"id": 1.*\}', result.stdout)
+        self.assertIsNotNone(match, result.stdout)
+        report = json.loads(match.group(0))
+        self.assertEqual(report["output"], "early\n")
+        self.assertEqual(report["bytes"], len("early\n"))
+        self.assertEqual(report["dropped"], 0)
+        self.assertFalse(report["complete"])
+
+    def test_output_limit(self):
+        """Test only the last JSHELL_JOB_OUTPUT bytes are kept."""
+        result = run_session(["/bin/echo abcdefgh &", "wait"],
+                             env={"JSHELL_JOB_OUTPUT": "5"})
+        self.assertIn("fgh\n", result.stdout)
+        self.assertNotIn("abcd", result.stdout)
+        self.assertIn("earlier bytes of output dropped", result.stdout)
+
+    def test_spooling_disabled(self):
+        """Test JSHELL_JOB_OUTPUT=0 leaves job output on the terminal."""
+        result = run_session(["/bin/echo direct &", "wait"],
+                             env={"JSHELL_JOB_OUTPUT": "0"})
+        self.assertIn("direct", result.stdout)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+"""Unit tests for the parallel builtin command."""
+
+import json
+import time
+import unittest
+
+from tests.helpers import JShellRunner
+
+
+class TestParallelBuiltin(unittest.TestCase):
+    """Test cases for the parallel builtin command."""
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the jshell binary exists before running tests."""
+        if not JShellRunner.exists():
+            raise unittest.SkipTest(
+                f"jshell binary not found at {JShellRunner.JSHELL}")
+
+    def test_help(self):
+        """Test -h flag shows help."""
+        result = JShellRunner.run("parallel -h")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("Usage: parallel", result.stdout)
+        self.assertIn("--jobs", result.stdout)
+
+    def test_output_in_input_order(self):
+        """Test output follows input order, not completion order."""
+        result = JShellRunner.run(
+            "parallel -j 3 sh -c 'sleep 0.$1; echo $1' _ ::: 3 1 2")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout.split(), ["3", "1", "2"])
+
+    def test_placeholder_substitution(self):
+        """Test {} is replaced by the input."""
+        result = JShellRunner.run("parallel echo item-{}.txt ::: a b")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout.split(), ["item-a.txt", "item-b.txt"])
+
+    def test_runs_concurrently(self):
+        """Test commands overlap when --jobs allows it."""
+        start = time.monotonic()
+        result = JShellRunner.run(
+            "parallel -j 8 sleep ::: 0.5 0.5 0.5 0.5 0.5 0.5 0.5 0.5")
+        elapsed = time.monotonic() - start
+        self.assertEqual(result.returncode, 0)
+        self.assertLess(elapsed, 3.0)
+
+    def test_exit_status_counts_failures(self):
+        """Test the exit status is the number of failed commands."""
+        result = JShellRunner.run("parallel sh -c 'exit $1' _ ::: 0 1 2 0")
+        self.assertEqual(result.returncode, 2)
+
+    def test_json(self):
+        """Test --json reports each input with its status and output."""
+        data = JShellRunner.run_json(
+            "parallel --json sh -c 'echo $1; exit $1' _ ::: 0 3")
+        self.assertEqual(data["failed"], 1)
+        self.assertEqual([t["input"] for t in data["tasks"]], ["0", "3"])
+        self.assertEqual(data["tasks"][0]["output"], "0\n")
+        self.assertEqual(data["tasks"][1]["exit_status"], 3)
+
+    def test_missing_command(self):
+        """Test an error is reported without a command."""
+        result = JShellRunner.run("parallel ::: a")
+        self.assertNotEqual(result.returncode, 0)
+        self.assertIn("missing command", result.stderr)
+
+    def test_state_builtin_rejected(self):
+        """Test builtins that change shell state are refused."""
+        result = JShellRunner.run("parallel cd ::: /tmp")
+        self.assertNotEqual(result.returncode, 0)
+        self.assertIn("cannot run in parallel", result.stderr)
+
+
+if __name__ == "__main__":
+    unittest.main()
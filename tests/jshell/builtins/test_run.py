@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+"""Unit tests for the run prefix (CPU, nice and cgroup placement)."""
+
+import json
+import os
+import unittest
+
+from tests.helpers import JShellRunner
+
+
+class TestRunBuiltin(unittest.TestCase):
+    """Test cases for the run prefix."""
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the jshell binary exists before running tests."""
+        if not JShellRunner.exists():
+            raise unittest.SkipTest(
+                f"jshell binary not found at {JShellRunner.JSHELL}")
+
+    def test_help(self):
+        """Test --help flag shows help."""
+        result = JShellRunner.run("run --help")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("Usage: run", result.stdout)
+        self.assertIn("--cgroup", result.stdout)
+
+    def test_missing_command(self):
+        """Test run without a command fails."""
+        result = JShellRunner.run("run --nice 5")
+        self.assertNotEqual(result.returncode, 0)
+        self.assertIn("missing command", result.stderr)
+
+    def test_bad_cpu_list(self):
+        """Test a malformed CPU list is refused before anything runs."""
+        result = JShellRunner.run("run --cpus 1-x /bin/echo ran")
+        self.assertEqual(result.returncode, 1)
+        self.assertIn("--cpus", result.stderr)
+        self.assertNotIn("ran", result.stdout)
+
+    def test_nice(self):
+        """Test the command runs at the given nice value."""
+        base = os.getpriority(os.PRIO_PROCESS, 0)
+        target = min(base + 5, 19)
+        result = JShellRunner.run(
+            f"run --nice {target} /bin/sh -c 'sleep 0.2; nice'")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout.strip(), str(target))
+
+    def test_cpus(self):
+        """Test the command is bound to the given CPUs."""
+        cpu = min(os.sched_getaffinity(0))
+        result = JShellRunner.run(
+            f"run --cpus {cpu} /bin/sh -c "
+            f"'sleep 0.2; grep Cpus_allowed_list /proc/self/status'")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout.split()[-1], str(cpu))
+
+    def test_linked_app_in_pipeline(self):
+        """Test a pipeline with linked apps still produces its output."""
+        result = JShellRunner.run("run --nice 19 echo one two | rg two")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout.strip(), "one two")
+
+    def test_after_time(self):
+        """Test run may follow the time prefix."""
+        result = JShellRunner.run("time run --nice 19 /bin/echo hi")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout.strip(), "hi")
+        self.assertIn("real", result.stderr)
+
+    def test_jobs_json_shows_placement(self):
+        """Test jobs --json reports the placement of a background job."""
+        cpu = min(os.sched_getaffinity(0))
+        result = JShellRunner.run(
+            f"run --cpus {cpu} --nice 19 sleep 1 &; jobs --json; wait")
+        self.assertEqual(result.returncode, 0)
+        start = result.stdout.index("{")
+        data = json.loads(result.stdout[start:])
+        self.assertEqual(data["jobs"][0]["sched"],
+                         {"cpus": str(cpu), "nice": 19})
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+"""Unit tests for the sleep builtin."""
+
+import json
+import signal
+import time
+import unittest
+
+from tests.helpers import JShellRunner, SignalTestHelper
+
+
+class TestSleepBuiltin(unittest.TestCase):
+    """Test cases for the sleep builtin."""
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the jshell binary exists before running tests."""
+        if not JShellRunner.exists():
+            raise unittest.SkipTest(
+                f"jshell binary not found at {JShellRunner.JSHELL}")
+
+    def test_help(self):
+        """Test --help flag shows help."""
+        result = JShellRunner.run("sleep --help")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("Usage: sleep", result.stdout)
+
+    def test_is_builtin(self):
+        """Test the shell's sleep is the builtin, not the linked app."""
+        result = JShellRunner.run("type sleep")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("sleep is a shell builtin", result.stdout)
+
+    def test_sleeps(self):
+        """Test a fractional sleep waits about as long as asked."""
+        start = time.monotonic()
+        result = JShellRunner.run("sleep 0.2")
+        elapsed = time.monotonic() - start
+        self.assertEqual(result.returncode, 0)
+        self.assertGreaterEqual(elapsed, 0.2)
+
+    def test_starts_no_process(self):
+        """Test repeated sleeps start no child process."""
+        result = JShellRunner.run(
+            "stats -r > /dev/null; sleep 0.01; sleep 0; stats --json")
+        self.assertEqual(result.returncode, 0)
+        stats = json.loads(result.stdout)
+        self.assertEqual(stats["spawns"] + stats["forks"], 0)
+        self.assertGreaterEqual(stats["cmd_builtin"] + stats["cmd_thread"], 2)
+
+    def test_interrupted(self):
+        """Test SIGINT ends a long sleep early."""
+        start = time.monotonic()
+        SignalTestHelper.run_jshell_with_signal("sleep 30", signal.SIGINT,
+                                                delay_ms=300, timeout=10)
+        self.assertLess(time.monotonic() - start, 5)
+
+    def test_invalid_interval(self):
+        """Test a negative interval is an error."""
+        result = JShellRunner.run("sleep -- -1")
+        self.assertNotEqual(result.returncode, 0)
+        self.assertIn("sleep", result.stderr)
+
+
+if __name__ == "__main__":
+    unittest.main()
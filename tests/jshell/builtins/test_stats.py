@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+"""Unit tests for the stats builtin."""
+
+import json
+import unittest
+
+from tests.helpers import JShellRunner
+
+
+class TestStatsBuiltin(unittest.TestCase):
+    """Test cases for the stats builtin."""
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the jshell binary exists before running tests."""
+        if not JShellRunner.exists():
+            raise unittest.SkipTest(
+                f"jshell binary not found at {JShellRunner.JSHELL}")
+
+    def test_help(self):
+        """Test --help flag shows help."""
+        result = JShellRunner.run("stats --help")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("Usage: stats", result.stdout)
+        self.assertIn("--reset", result.stdout)
+
+    def test_text_output(self):
+        """Test every counter is printed as a name and a value."""
+        result = JShellRunner.run("stats")
+        self.assertEqual(result.returncode, 0)
+        names = [line.split()[0] for line in result.stdout.splitlines()]
+        for name in ("cmd_builtin", "cmd_external", "spawns",
+                     "path_cache_hits", "capture_bytes", "pkg_reloads",
+                     "parse_cache_hit_rate"):
+            self.assertIn(name, names)
+
+    def test_json_counts_commands(self):
+        """Test --json reflects the commands run before it."""
+        result = JShellRunner.run(
+            "/bin/true; /bin/true; x=$(echo hello); stats --json")
+        self.assertEqual(result.returncode, 0)
+        stats = json.loads(result.stdout)
+        self.assertGreaterEqual(stats["cmd_external"], 2)
+        self.assertGreaterEqual(stats["spawns"] + stats["forks"], 2)
+        self.assertGreaterEqual(stats["captures"], 1)
+        self.assertGreaterEqual(stats["capture_bytes"], len("hello\n"))
+        self.assertGreaterEqual(stats["parse_cache_misses"], 1)
+        self.assertGreaterEqual(stats["cmd_builtin"] + stats["cmd_thread"], 1)
+        self.assertLessEqual(stats["path_cache_hit_rate"], 1.0)
+
+    def test_reset(self):
+        """Test -r starts counting from zero after printing."""
+        result = JShellRunner.run(
+            "/bin/true; stats -r > /dev/null; stats --json")
+        self.assertEqual(result.returncode, 0)
+        stats = json.loads(result.stdout)
+        self.assertEqual(stats["cmd_external"], 0)
+        self.assertEqual(stats["spawns"], 0)
+
+    def test_invalid_option(self):
+        """Test an unknown option is an error."""
+        result = JShellRunner.run("stats --bogus")
+        self.assertNotEqual(result.returncode, 0)
+        self.assertIn("stats", result.stderr)
+
+
+if __name__ == "__main__":
+    unittest.main()
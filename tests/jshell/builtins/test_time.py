@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+"""Unit tests for the time prefix and job resource accounting."""
+
+import json
+import unittest
+
+from tests.helpers import JShellRunner
+
+
+class TestTimeBuiltin(unittest.TestCase):
+    """Test cases for the time prefix."""
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the jshell binary exists before running tests."""
+        if not JShellRunner.exists():
+            raise unittest.SkipTest(
+                f"jshell binary not found at {JShellRunner.JSHELL}")
+
+    def test_help(self):
+        """Test --help flag shows help."""
+        result = JShellRunner.run("time --help")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("Usage: time", result.stdout)
+        self.assertIn("--json", result.stdout)
+
+    def test_missing_command(self):
+        """Test time without a command fails."""
+        result = JShellRunner.run("time")
+        self.assertNotEqual(result.returncode, 0)
+        self.assertIn("missing command", result.stderr)
+
+    def test_text_report_on_stderr(self):
+        """Test the report goes to stderr and output is untouched."""
+        result = JShellRunner.run("time /bin/echo hello")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout.strip(), "hello")
+        self.assertIn("real", result.stderr)
+        self.assertIn("maxrss", result.stderr)
+
+    def test_keeps_exit_status(self):
+        """Test the timed command's exit status is kept."""
+        result = JShellRunner.run("time /bin/sh -c 'exit 3'")
+        self.assertEqual(result.returncode, 3)
+
+    def test_json_pipeline_stages(self):
+        """Test --json reports totals and one entry per stage."""
+        result = JShellRunner.run("time --json /bin/echo hi | /bin/cat")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout.strip(), "hi")
+        report = json.loads(result.stderr.strip().splitlines()[-1])
+        self.assertEqual(report["status"], 0)
+        for key in ("wall_ms", "user_ms", "sys_ms", "max_rss_kb"):
+            self.assertIn(key, report)
+        self.assertEqual([stage["command"] for stage in report["stages"]],
+                         ["/bin/echo hi", "/bin/cat"])
+        self.assertGreater(report["stages"][0]["max_rss_kb"], 0)
+
+    def test_json_builtin_stage(self):
+        """Test a builtin stage is timed on its thread."""
+        result = JShellRunner.run("time --json pwd")
+        self.assertEqual(result.returncode, 0)
+        report = json.loads(result.stderr.strip().splitlines()[-1])
+        self.assertEqual(report["stages"][0]["command"], "pwd")
+
+
+class TestJobUsage(unittest.TestCase):
+    """Test cases for resource usage of background jobs."""
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the jshell binary exists before running tests."""
+        if not JShellRunner.exists():
+            raise unittest.SkipTest(
+                f"jshell binary not found at {JShellRunner.JSHELL}")
+
+    def test_jobs_json_reports_usage(self):
+        """Test jobs --json includes wall, CPU and memory per job."""
+        result = JShellRunner.run("/bin/sleep 1 &; jobs --json")
+        self.assertEqual(result.returncode, 0)
+        start = result.stdout.index("{")
+        jobs = json.loads(result.stdout[start:])["jobs"]
+        self.assertEqual(len(jobs), 1)
+        for key in ("wall_ms", "user_ms", "sys_ms", "max_rss_kb"):
+            self.assertIn(key, jobs[0])
+
+    def test_ps_json_reports_usage(self):
+        """Test ps --json includes usage of each running process."""
+        result = JShellRunner.run("/bin/sleep 1 &; ps --json")
+        self.assertEqual(result.returncode, 0)
+        start = result.stdout.index("{")
+        processes = json.loads(result.stdout[start:])["processes"]
+        self.assertEqual(len(processes), 1)
+        self.assertIn("user_ms", processes[0])
+        self.assertGreater(processes[0]["max_rss_kb"], 0)
+
+
+if __name__ == "__main__":
+    unittest.main()
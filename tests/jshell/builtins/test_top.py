@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+"""Unit tests for the top builtin."""
+
+import json
+import unittest
+
+from tests.helpers import JShellRunner
+
+
+class TestTopBuiltin(unittest.TestCase):
+    """Test cases for the top builtin."""
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the jshell binary exists before running tests."""
+        if not JShellRunner.exists():
+            raise unittest.SkipTest(
+                f"jshell binary not found at {JShellRunner.JSHELL}")
+
+    def test_help(self):
+        """Test --help flag shows help."""
+        result = JShellRunner.run("top --help")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("Usage: top", result.stdout)
+        self.assertIn("--interval", result.stdout)
+
+    def test_text_snapshot(self):
+        """Test one text frame is printed when output is not a terminal."""
+        result = JShellRunner.run("top -d 0.1 -l 5")
+        self.assertEqual(result.returncode, 0)
+        lines = result.stdout.splitlines()
+        self.assertTrue(lines[0].startswith("top - "))
+        self.assertIn("%CPU", lines[2])
+        self.assertLessEqual(len(lines), 3 + 5)
+
+    def test_json_stream(self):
+        """Test --json prints one object per sample."""
+        result = JShellRunner.run("top --json -d 0.1 -n 3 -l 4")
+        self.assertEqual(result.returncode, 0)
+        samples = [json.loads(line) for line in result.stdout.splitlines()]
+        self.assertEqual(len(samples), 3)
+        for sample in samples:
+            for key in ("time_ms", "interval_ms", "cpu_percent", "load",
+                        "mem_total_kb", "processes"):
+                self.assertIn(key, sample)
+            self.assertLessEqual(len(sample["processes"]), 4)
+            for proc in sample["processes"]:
+                for key in ("pid", "state", "cpu_percent", "rss_kb",
+                            "cpu_time_ms", "command"):
+                    self.assertIn(key, proc)
+
+    def test_jobs_only(self):
+        """Test -j watches the processes of the shell's jobs."""
+        result = JShellRunner.run(
+            "/bin/sleep 2 &; top --json -j -d 0.1 -n 1")
+        self.assertEqual(result.returncode, 0)
+        sample = json.loads(result.stdout.strip().splitlines()[-1])
+        self.assertEqual(len(sample["processes"]), 1)
+        proc = sample["processes"][0]
+        self.assertIn("job_id", proc)
+        self.assertIn("sleep 2", proc["command"])
+
+    def test_invalid_pid(self):
+        """Test a PID that is not a number is rejected."""
+        result = JShellRunner.run("top -p abc")
+        self.assertNotEqual(result.returncode, 0)
+        self.assertIn("invalid PID", result.stderr)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+"""Unit tests for the where builtin command."""
+
+import json
+import os
+import tempfile
+import unittest
+
+from tests.helpers import JShellRunner
+
+
+class TestWhereBuiltin(unittest.TestCase):
+    """Test cases for the where builtin command."""
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the jshell binary exists before running tests."""
+        if not JShellRunner.exists():
+            raise unittest.SkipTest(
+                f"jshell binary not found at {JShellRunner.JSHELL}")
+
+    def setUp(self):
+        """Create a directory with a few files of known sizes."""
+        self.tmp = tempfile.TemporaryDirectory()
+        for name, size in (("small.txt", 10), ("big.txt", 5000),
+                           ("big.log", 8000)):
+            with open(os.path.join(self.tmp.name, name), "w") as f:
+                f.write("x" * size)
+        os.mkdir(os.path.join(self.tmp.name, "sub"))
+
+    def tearDown(self):
+        """Remove the directory."""
+        self.tmp.cleanup()
+
+    def names(self, stdout):
+        """Names of the NDJSON objects in stdout, sorted."""
+        return sorted(json.loads(line)["name"]
+                      for line in stdout.splitlines() if line)
+
+    def test_help(self):
+        """Test -h flag shows help."""
+        result = JShellRunner.run("where -h")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("Usage: where", result.stdout)
+        self.assertIn("FIELD OP VALUE", result.stdout)
+
+    def test_filters_ndjson_file(self):
+        """Test objects read as NDJSON text are filtered by a string."""
+        path = os.path.join(self.tmp.name, "in.ndjson")
+        with open(path, "w") as f:
+            f.write('{"name": "a", "kind": "x"}\n'
+                    '{"name": "b", "kind": "y"}\n')
+        result = JShellRunner.run(f"where kind eq y < {path}")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout.splitlines(),
+                         ['{"name": "b", "kind": "y"}'])
+
+    def test_filters_ls_records(self):
+        """Test ls --json-stream feeding where prints only matches."""
+        result = JShellRunner.run(
+            f"ls --json-stream {self.tmp.name} | where size gt 1000")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(self.names(result.stdout), ["big.log", "big.txt"])
+
+    def test_chained_filters(self):
+        """Test records passed between two where stages."""
+        result = JShellRunner.run(
+            f"ls --json-stream {self.tmp.name} | where type eq file"
+            f" | where name has .txt")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(self.names(result.stdout), ["big.txt", "small.txt"])
+        for line in result.stdout.splitlines():
+            self.assertIn('"size": ', line)
+
+    def test_records_rendered_for_capture(self):
+        """Test a captured record pipeline holds JSON text."""
+        result = JShellRunner.run(
+            f"SUB=ls --json-stream {self.tmp.name} | where name eq sub;"
+            f" echo $SUB")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("directory", result.stdout)
+        self.assertNotIn("\x1e", result.stdout)
+
+    def test_bad_input_line(self):
+        """Test a line that is not an object is reported and skipped."""
+        path = os.path.join(self.tmp.name, "in.ndjson")
+        with open(path, "w") as f:
+            f.write('not json\n{"name": "a"}\n')
+        result = JShellRunner.run(f"where name eq a < {path}")
+        self.assertEqual(result.returncode, 1)
+        self.assertEqual(result.stdout.splitlines(), ['{"name": "a"}'])
+
+    def test_unknown_operator(self):
+        """Test an unknown operator is an error."""
+        result = JShellRunner.run("where size about 10 < /dev/null")
+        self.assertEqual(result.returncode, 1)
+        self.assertIn("unknown operator", result.stderr)
+
+
+if __name__ == "__main__":
+    unittest.main()
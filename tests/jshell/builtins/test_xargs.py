@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+"""Unit tests for the xargs builtin command."""
+
+import os
+import tempfile
+import unittest
+
+from tests.helpers import JShellRunner
+
+
+class TestXargsBuiltin(unittest.TestCase):
+    """Test cases for the xargs builtin command."""
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the jshell binary exists before running tests."""
+        if not JShellRunner.exists():
+            raise unittest.SkipTest(
+                f"jshell binary not found at {JShellRunner.JSHELL}")
+
+    def setUp(self):
+        """Create a directory for input files."""
+        self.tmp = tempfile.TemporaryDirectory()
+
+    def tearDown(self):
+        """Remove the directory."""
+        self.tmp.cleanup()
+
+    def items_file(self, items, sep="\n"):
+        """Write items to a file and return its path."""
+        path = os.path.join(self.tmp.name, "items")
+        with open(path, "w") as f:
+            f.write(sep.join(items) + sep)
+        return path
+
+    def test_help(self):
+        """Test -h flag shows help."""
+        result = JShellRunner.run("xargs -h")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("Usage: xargs", result.stdout)
+        self.assertIn("--max-procs", result.stdout)
+
+    def test_batches_into_one_run(self):
+        """Test all items go to a single run of an in-process command."""
+        path = self.items_file(["a", "b", "", "c"])
+        result = JShellRunner.run(f"xargs echo x < {path}")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, "x a b c\n")
+
+    def test_max_args(self):
+        """Test -n limits the items per run."""
+        path = self.items_file([str(i) for i in range(5)])
+        result = JShellRunner.run(f"xargs -n 2 echo < {path}")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout.splitlines(), ["0 1", "2 3", "4"])
+
+    def test_null_separated(self):
+        """Test -0 splits on NUL and keeps newlines in items."""
+        path = self.items_file(["one two", "three"], sep="\0")
+        result = JShellRunner.run(f"xargs -0 -n 1 echo < {path}")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout.splitlines(), ["one two", "three"])
+
+    def test_spawned_command(self):
+        """Test a program from PATH gets the items as arguments."""
+        path = self.items_file(["a", "b"])
+        result = JShellRunner.run(f"xargs sh -c 'echo $#' _ < {path}")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, "2\n")
+
+    def test_parallel_output_in_order(self):
+        """Test -P keeps output in batch order."""
+        path = self.items_file(["0.3", "0.1", "0.2"])
+        result = JShellRunner.run(
+            f"xargs -P 3 -n 1 sh -c 'sleep $1; echo $1' _ < {path}")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout.split(), ["0.3", "0.1", "0.2"])
+
+    def test_linked_app(self):
+        """Test a linked app is run over the items from a pipeline."""
+        for name in ("a.txt", "b.txt"):
+            with open(os.path.join(self.tmp.name, name), "w") as f:
+                f.write(f"in {name}\n")
+        result = JShellRunner.run(
+            f"ls {self.tmp.name} | xargs -n 1 -P 2 echo", cwd=self.tmp.name)
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout.split(), ["a.txt", "b.txt"])
+        path = self.items_file(["a.txt", "b.txt"])
+        result = JShellRunner.run(f"xargs cat < {path}", cwd=self.tmp.name)
+        self.assertEqual(result.stdout, "in a.txt\nin b.txt\n")
+
+    def test_registered_external_spawned(self):
+        """Test a registered external that is not linked is spawned."""
+        path = self.items_file(["--help"])
+        result = JShellRunner.run(f"xargs pkg < {path}")
+        self.assertNotIn("cannot be run", result.stderr)
+
+    def test_failure_status(self):
+        """Test a failing run makes the status 123."""
+        path = self.items_file(["0", "3"])
+        result = JShellRunner.run(f"xargs -n 1 sh -c 'exit $1' _ < {path}")
+        self.assertEqual(result.returncode, 123)
+
+    def test_empty_input(self):
+        """Test the command does not run without items."""
+        result = JShellRunner.run("xargs echo ran < /dev/null")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout, "")
+
+    def test_state_builtin_rejected(self):
+        """Test builtins that change shell state are refused."""
+        path = self.items_file(["/tmp"])
+        result = JShellRunner.run(f"xargs cd < {path}")
+        self.assertNotEqual(result.returncode, 0)
+        self.assertIn("changes shell state", result.stderr)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,205 @@
+#!/usr/bin/env python3
+"""Unit tests for the cache of AI-generated commands (@!query)."""
+
+import os
+import re
+import subprocess
+import tempfile
+import time
+import unittest
+from pathlib import Path
+
+from tests.helpers import JShellRunner, MockGeminiServer
+
+
+class AICacheTestBase(unittest.TestCase):
+    """Run @! queries against a fake API with a fresh ~/.jshell."""
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the jshell binary exists before running tests."""
+        if not JShellRunner.exists():
+            raise unittest.SkipTest(
+                f"jshell binary not found at {JShellRunner.JSHELL}")
+
+    def setUp(self):
+        """Start the fake API and make an empty home directory."""
+        self.api = MockGeminiServer("echo first")
+        self.tmp = tempfile.TemporaryDirectory()
+        self.home = Path(self.tmp.name)
+        self.cache_file = self.home / ".jshell" / "ai-cache"
+
+    def tearDown(self):
+        """Stop the fake API and remove the home directory."""
+        self.api.close()
+        self.tmp.cleanup()
+
+    def ask(self, *queries) -> subprocess.CompletedProcess:
+        """Ask each query in turn in one session, declining every command.
+
+        Returns:
+            CompletedProcess whose proposals attribute lists the commands
+            proposed, in order
+        """
+        script = self.home / "queries.jsh"
+        script.write_text("".join(f"@!{q}\n" for q in queries))
+        env = {**os.environ, "ASAN_OPTIONS": "detect_leaks=0",
+               "HOME": str(self.home), **self.api.env()}
+        result = subprocess.run(
+            [str(JShellRunner.JSHELL), str(script)],
+            input="n\n" * len(queries), capture_output=True, text=True,
+            env=env, cwd=self.tmp.name, timeout=30)
+        result.proposals = re.findall(r"^Proposed command: (.*)$",
+                                      result.stdout, re.MULTILINE)
+        return result
+
+    def cache_lines(self) -> list:
+        """Return the lines of ~/.jshell/ai-cache split into fields.
+
+        Returns:
+            List of [time, fingerprint, query, command]
+        """
+        lines = []
+        for line in self.cache_file.read_text().splitlines():
+            head, command = line.split("\t", 1)
+            stored, fingerprint, query = head.split(" ", 2)
+            lines.append([int(stored), fingerprint, query, command])
+        return lines
+
+    def write_cache_lines(self, lines: list):
+        """Replace ~/.jshell/ai-cache with the given fields."""
+        self.cache_file.write_text("".join(
+            f"{stored} {fingerprint} {query}\t{command}\n"
+            for stored, fingerprint, query, command in lines))
+
+
+class TestAICommandCache(AICacheTestBase):
+    """Test cases for memoized @! answers."""
+
+    def test_exact_repeat_is_hit(self):
+        """Test a repeat differing only in case and spacing asks once."""
+        result = self.ask("list json files", "List  JSON   files")
+        self.assertEqual(result.proposals, ["echo first", "echo first"])
+        self.assertEqual(self.api.requests, 1)
+
+    def test_repeat_in_new_session_is_hit(self):
+        """Test a query answered in one session is cached for the next."""
+        self.ask("list json files")
+        self.api.answer = "echo second"
+        result = self.ask("list json files")
+        self.assertEqual(result.proposals, ["echo first"])
+        self.assertEqual(self.api.requests, 1)
+        lines = self.cache_lines()
+        self.assertEqual(len(lines), 1)
+        self.assertEqual(lines[0][2:], ["list json files", "echo first"])
+
+    def test_other_query_is_miss(self):
+        """Test a different query goes to the API."""
+        result = self.ask("list json files", "count lines of main.c")
+        self.assertEqual(len(result.proposals), 2)
+        self.assertEqual(self.api.requests, 2)
+
+    def test_no_cache_replaces_answer(self):
+        """Test --no-cache asks again and its answer is the one kept."""
+        self.ask("list json files")
+        self.api.answer = "echo second"
+        result = self.ask("--no-cache list json files", "list json files")
+        self.assertEqual(result.proposals, ["echo second", "echo second"])
+        self.assertEqual(self.api.requests, 2)
+
+    def test_expired_entry_is_miss(self):
+        """Test an answer older than a week is not reused."""
+        self.ask("list json files")
+        week = 7 * 24 * 60 * 60
+        self.write_cache_lines([[int(time.time()) - week - 60, *fields]
+                                for _, *fields in self.cache_lines()])
+        self.api.answer = "echo second"
+        result = self.ask("list json files")
+        self.assertEqual(result.proposals, ["echo second"])
+        self.assertEqual(self.api.requests, 2)
+
+    def test_other_fingerprint_is_miss(self):
+        """Test an answer given with other commands registered is stale."""
+        self.ask("list json files")
+        self.write_cache_lines([[stored, "0" * 16, query, command]
+                                for stored, _, query, command
+                                in self.cache_lines()])
+        self.api.answer = "echo second"
+        result = self.ask("list json files")
+        self.assertEqual(result.proposals, ["echo second"])
+        self.assertEqual(self.api.requests, 2)
+
+    def test_oversized_file_drops_expired_lines(self):
+        """Test the file is rewritten without expired lines past 256 KB."""
+        self.ask("list json files")
+        live = self.cache_lines()
+        old = int(time.time()) - 8 * 24 * 60 * 60
+        stale = [[old, live[0][1], f"old query {i}", "echo old"]
+                 for i in range(10000)]
+        self.write_cache_lines(stale + live)
+        self.assertGreater(self.cache_file.stat().st_size, 256 * 1024)
+
+        self.ask("count lines of main.c")
+        lines = self.cache_lines()
+        self.assertEqual([line[2] for line in lines],
+                         ["list json files", "count lines of main.c"])
+        self.assertEqual(self.api.requests, 2)
+
+
+class TestAISimilarQueries(AICacheTestBase):
+    """Test cases for reusing the answer to a differently worded query."""
+
+    def test_near_match_is_reused(self):
+        """Test fillers, synonyms and plurals do not make a new query."""
+        result = self.ask("list json files here",
+                          "show the json file in this dir")
+        self.assertEqual(result.proposals, ["echo first", "echo first"])
+        self.assertEqual(self.api.requests, 1)
+        self.assertIn('reusing the command for "list json files here"',
+                      result.stderr)
+
+    def test_near_match_in_new_session_is_reused(self):
+        """Test a near match is found in the cache file too."""
+        self.ask("list json files here")
+        result = self.ask("display json files in the current directory")
+        self.assertEqual(result.proposals, ["echo first"])
+        self.assertEqual(self.api.requests, 1)
+
+    def test_other_words_below_threshold_are_miss(self):
+        """Test a query sharing only some words asks the API."""
+        self.ask("list json files")
+        self.api.answer = "echo second"
+        result = self.ask("delete json files")
+        self.assertEqual(result.proposals, ["echo second"])
+        self.assertEqual(self.api.requests, 2)
+        self.assertNotIn("reusing", result.stderr)
+
+    def test_other_literal_is_miss(self):
+        """Test file names must match even when the words do."""
+        result = self.ask("count lines of main.c", "count lines of util.c")
+        self.assertEqual(self.api.requests, 2)
+        self.assertNotIn("reusing", result.stderr)
+
+    def test_unparsable_command_is_not_reused(self):
+        """Test a near match is dropped if its command does not parse."""
+        self.api.answer = "ls | |"
+        self.ask("list json files here")
+        self.api.answer = "echo second"
+        result = self.ask("show json files in this dir")
+        self.assertEqual(result.proposals, ["echo second"])
+        self.assertEqual(self.api.requests, 2)
+
+    def test_expired_near_match_is_miss(self):
+        """Test an answer older than a week is not reused for a near match."""
+        self.ask("list json files here")
+        week = 7 * 24 * 60 * 60
+        self.write_cache_lines([[int(time.time()) - week - 60, *fields]
+                                for _, *fields in self.cache_lines()])
+        self.api.answer = "echo second"
+        result = self.ask("show json files in this dir")
+        self.assertEqual(result.proposals, ["echo second"])
+        self.assertEqual(self.api.requests, 2)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -1,6 +1,7 @@
 #!/usr/bin/env python3
 """Unit tests for AST execution in jshell."""
 
+import json
 import os
 import tempfile
 import unittest
@@ -122,6 +123,26 @@ class TestVariableExpansion(unittest.TestCase):
         self.assertEqual(result.returncode, 0)
         self.assertIn("HOME=/", result.stdout)
 
+    def test_unquoted_variable_is_split(self):
+        """Test an unquoted variable splits into separate arguments."""
+        result = JShellRunner.run('echo $SPLIT_VAR',
+                                  env={"SPLIT_VAR": "one   two"})
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout.strip(), "one two")
+
+    def test_quoted_variable_is_not_split(self):
+        """Test a quoted variable keeps its whitespace."""
+        result = JShellRunner.run('echo "$SPLIT_VAR"',
+                                  env={"SPLIT_VAR": "one   two"})
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout.strip(), "one   two")
+
+    def test_default_value_expansion(self):
+        """Test ${VAR:-default} (handled by the wordexp fallback)."""
+        result = JShellRunner.run('echo ${UNDEFINED_VAR_12345:-fallback}')
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout.strip(), "fallback")
+
 
 class TestTildeExpansion(unittest.TestCase):
     """Test cases for tilde expansion."""
@@ -180,6 +201,12 @@ class TestGlobExpansion(unittest.TestCase):
         self.assertIn("test1.txt", result.stdout)
         self.assertIn("test2.txt", result.stdout)
 
+    def test_quoted_glob_is_literal(self):
+        """Test a quoted glob pattern is not expanded."""
+        result = JShellRunner.run(f'echo "{self.temp_dir}/*.txt"')
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout.strip(), f"{self.temp_dir}/*.txt")
+
 
 class TestInputRedirection(unittest.TestCase):
     """Test cases for input redirection."""
@@ -303,6 +330,76 @@ class TestVariableAssignment(unittest.TestCase):
         # MYVAR should contain the pwd output
         self.assertTrue(result.stdout.strip().startswith("/"))
 
+    def test_large_command_substitution_not_truncated(self):
+        """Test captured output larger than 8 KB is kept in full."""
+        with tempfile.NamedTemporaryFile("w", suffix=".txt",
+                                         delete=False) as f:
+            f.write("x" * 20000)
+            path = f.name
+        try:
+            result = JShellRunner.run(f"BIG=cat {path}; echo $BIG")
+            self.assertEqual(result.returncode, 0)
+            # Once from the tee of the assignment, once from echo
+            self.assertEqual(result.stdout.count("x"), 40000)
+        finally:
+            os.unlink(path)
+
+    def test_large_capture_from_stream_writer(self):
+        """Test rg output captured in memory is kept in full and echoed."""
+        with tempfile.NamedTemporaryFile("w", suffix=".txt",
+                                         delete=False) as f:
+            f.write("".join(f"hit {i}\n" for i in range(5000)))
+            path = f.name
+        try:
+            trace_path = path + ".trace"
+            result = JShellRunner.run(f"HITS=rg hit {path}; echo $HITS",
+                                      env={"JSHELL_TRACE": trace_path})
+            self.assertEqual(result.returncode, 0)
+            # Once from the tee of the assignment, once from echo
+            self.assertEqual(result.stdout.count("hit 4999"), 2)
+            with open(trace_path, encoding="utf-8") as f:
+                events = json.load(f)["traceEvents"]
+            captures = [event.get("args", {}).get("detail")
+                        for event in events if event["name"] == "capture"]
+            self.assertEqual(captures, ["memory"])
+        finally:
+            os.unlink(path)
+            if os.path.exists(path + ".trace"):
+                os.unlink(path + ".trace")
+
+    def test_builtin_pipeline_captured_in_memory(self):
+        """Test a builtin last stage of an assigned pipeline is captured."""
+        result = JShellRunner.run("TYPES=pwd | type cd; echo $TYPES")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout.count("cd is a shell builtin"), 2)
+
+    def test_assignment_is_shell_local(self):
+        """Test an assigned variable is not passed to commands."""
+        result = JShellRunner.run('MYVAR=pwd; env')
+        self.assertEqual(result.returncode, 0)
+        self.assertNotIn("MYVAR=", result.stdout)
+
+    def test_export_existing_variable(self):
+        """Test export NAME passes a shell variable to commands."""
+        result = JShellRunner.run('MYVAR=pwd; export MYVAR; env')
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("MYVAR=/", result.stdout)
+
+    def test_assignment_keeps_exported_variable_exported(self):
+        """Test assigning to an exported variable updates the environment."""
+        result = JShellRunner.run('export "MYVAR=old"; MYVAR=pwd; env')
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("MYVAR=/", result.stdout)
+        self.assertNotIn("MYVAR=old", result.stdout)
+
+    def test_shell_local_variable_in_fallback_expansion(self):
+        """Test ${NAME:-word}, expanded by wordexp(), sees local variables."""
+        result = JShellRunner.run('MYVAR=pwd; echo ${MYVAR:-unset}')
+        self.assertEqual(result.returncode, 0)
+        self.assertNotIn("unset", result.stdout)
+        self.assertEqual(result.stdout.count("/"),
+                         2 * result.stdout.splitlines()[0].count("/"))
+
 
 class TestExitCodes(unittest.TestCase):
     """Test cases for exit code handling."""
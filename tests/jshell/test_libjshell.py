@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+"""Unit tests for the libjshell embedding API."""
+
+import os
+import subprocess
+import tempfile
+import time
+import unittest
+from pathlib import Path
+
+
+PROJECT_ROOT = Path(__file__).parent.parent.parent
+LIBJSHELL = PROJECT_ROOT / "build" / "lib" / "libjshell.a"
+
+# Runs each argument as a line of one session; a line starting with '!'
+# has its output collected in the session buffers instead of streamed
+HOST_SOURCE = r"""
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "jshell/jshell_session.h"
+
+/* fd 1 is a capture pipe while a line runs */
+static FILE *report;
+
+static void on_out(const char *data, size_t len, void *user) {
+  (void)user;
+  fprintf(report, "out:%.*s", (int)len, data);
+}
+
+static void on_err(const char *data, size_t len, void *user) {
+  (void)user;
+  fprintf(report, "err:%.*s", (int)len, data);
+}
+
+int main(int argc, char **argv) {
+  report = fdopen(dup(1), "w");
+  JShellSession *session = jshell_session_new();
+  if (session == NULL) {
+    return 100;
+  }
+  for (int i = 1; i < argc; i++) {
+    int status;
+    if (argv[i][0] == '!') {
+      status = jshell_session_exec(session, argv[i] + 1, NULL, NULL, NULL);
+      fprintf(report, "buffered:%s|%s", jshell_session_stdout(session, NULL),
+              jshell_session_stderr(session, NULL));
+    } else {
+      status = jshell_session_exec(session, argv[i], on_out, on_err, NULL);
+    }
+    fprintf(report, "status:%d\n", status);
+  }
+  jshell_session_free(session);
+  fclose(report);
+  return 0;
+}
+"""
+
+
+class TestLibJShell(unittest.TestCase):
+    """Test cases for a host running lines through jshell_session_exec."""
+
+    @classmethod
+    def setUpClass(cls):
+        """Build a small host program against the library."""
+        if not LIBJSHELL.exists():
+            raise unittest.SkipTest(
+                f"libjshell not found at {LIBJSHELL} (make libjshell)")
+        cls.tmpdir = tempfile.TemporaryDirectory()
+        source = Path(cls.tmpdir.name) / "host.c"
+        source.write_text(HOST_SOURCE)
+        cls.host = Path(cls.tmpdir.name) / "host"
+        curl_lib = PROJECT_ROOT / "extern" / "curl" / "build" / "lib" / "libcurl.a"
+        build = subprocess.run(
+            ["gcc", "-fsanitize=address,undefined", f"-I{PROJECT_ROOT / 'src'}",
+             str(source), str(LIBJSHELL), str(curl_lib), "-lssl", "-lcrypto",
+             "-lz", "-lpthread", "-lidn2", "-lzstd", "-lm",
+             "-o", str(cls.host)],
+            capture_output=True, text=True)
+        if build.returncode != 0:
+            cls.tmpdir.cleanup()
+            raise unittest.SkipTest(f"cannot link a host: {build.stderr}")
+
+    @classmethod
+    def tearDownClass(cls):
+        """Remove the host program."""
+        cls.tmpdir.cleanup()
+
+    def run_host(self, *lines, cwd=None):
+        """Run the host with one session over lines."""
+        env = {**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
+        return subprocess.run([str(self.host), *lines], capture_output=True,
+                              text=True, env=env, cwd=cwd, timeout=30)
+
+    def test_callbacks(self):
+        """Test output reaches the callbacks and the status is returned."""
+        result = self.run_host("echo hello; ls /nonexistent")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("out:hello\n", result.stdout)
+        self.assertIn("err:", result.stdout)
+        self.assertRegex(result.stdout, r"status:[1-9]")
+
+    def test_buffers(self):
+        """Test a NULL callback collects output in the session buffer."""
+        result = self.run_host("!echo one", "!echo two")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout,
+                         "buffered:one\n|status:0\nbuffered:two\n|status:0\n")
+
+    def test_parse_error(self):
+        """Test a parse error is reported on the error stream."""
+        result = self.run_host("echo 'unterminated")
+        self.assertIn("err:jshell: parse error", result.stdout)
+        self.assertIn("status:1", result.stdout)
+
+    def test_session_cwd(self):
+        """Test cd persists for the session but not for the host."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            result = self.run_host("cd /", "pwd", cwd=tmpdir)
+            self.assertIn("out:/\n", result.stdout)
+            self.assertEqual(result.stderr, "")
+
+    def test_background_job_does_not_block(self):
+        """Test a line returns while a background job still runs."""
+        start = time.monotonic()
+        result = self.run_host("/bin/sleep 5 &", "echo done")
+        self.assertIn("out:done\n", result.stdout)
+        self.assertLess(time.monotonic() - start, 4)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+"""Unit tests for interactive line editing and tab completion."""
+
+import os
+import pty
+import select
+import tempfile
+import time
+import unittest
+
+from tests.helpers import JShellRunner
+
+
+class TestLineEditor(unittest.TestCase):
+    """Test cases for the line editor used when jshell runs on a terminal."""
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the jshell binary exists before running tests."""
+        if not JShellRunner.exists():
+            raise unittest.SkipTest(
+                f"jshell binary not found at {JShellRunner.JSHELL}")
+
+    def setUp(self):
+        self.tmpdir = tempfile.TemporaryDirectory()
+        self.addCleanup(self.tmpdir.cleanup)
+
+    def session(self, keys):
+        """Type keys into an interactive jshell on a pty, return its output."""
+        pid, fd = pty.fork()
+        if pid == 0:
+            os.chdir(self.tmpdir.name)
+            os.environ["HOME"] = self.tmpdir.name
+            os.environ["ASAN_OPTIONS"] = "detect_leaks=0"
+            os.execv(str(JShellRunner.JSHELL), [str(JShellRunner.JSHELL)])
+
+        output = bytearray()
+
+        def drain(seconds):
+            end = time.time() + seconds
+            while time.time() < end:
+                ready, _, _ = select.select([fd], [], [], 0.02)
+                if ready:
+                    try:
+                        data = os.read(fd, 65536)
+                    except OSError:
+                        return False
+                    if not data:
+                        return False
+                    output.extend(data)
+            return True
+
+        try:
+            drain(0.5)
+            for key in keys:
+                os.write(fd, key.encode())
+                drain(0.2)
+            os.write(fd, b"exit\r")
+            drain(1.0)
+            _, status = os.waitpid(pid, 0)
+            self.assertEqual(os.waitstatus_to_exitcode(status), 0)
+        finally:
+            os.close(fd)
+        return output.decode(errors="replace")
+
+    def test_complete_builtin_name(self):
+        """Test Tab completes a unique command prefix and adds a space."""
+        output = self.session(["ech\t", "completed-word\r"])
+        self.assertIn("echo completed-word", output)
+        self.assertIn("\ncompleted-word", output.replace("\r", ""))
+
+    def test_complete_file_name(self):
+        """Test Tab completes a file name argument."""
+        with open(os.path.join(self.tmpdir.name, "notes-unique.txt"),
+                  "w") as f:
+            f.write("file contents here\n")
+        output = self.session(["cat notes-u\t", "\r"])
+        self.assertIn("cat notes-unique.txt", output)
+        self.assertIn("file contents here", output)
+
+    def test_complete_directory_keeps_slash(self):
+        """Test a directory completes with a trailing slash and no space."""
+        os.makedirs(os.path.join(self.tmpdir.name, "subdir-only", "inner"))
+        output = self.session(["ls subdir-o\t", "\t", "\r"])
+        self.assertIn("ls subdir-only/inner/", output)
+
+    def test_double_tab_lists_candidates(self):
+        """Test a second Tab lists ambiguous candidates."""
+        for name in ("alpha-one", "alpha-two"):
+            open(os.path.join(self.tmpdir.name, name), "w").close()
+        output = self.session(["cat alpha-\t", "\t", "\x15"])
+        self.assertIn("alpha-one", output)
+        self.assertIn("alpha-two", output)
+
+    def test_history_up_arrow(self):
+        """Test Up recalls the previous command."""
+        output = self.session(["echo recalled-line\r", "\x1b[A", "\r"])
+        self.assertEqual(output.replace("\r", "").count("\nrecalled-line"),
+                         2)
+
+    def test_ctrl_c_discards_line(self):
+        """Test Ctrl-C abandons the line being typed."""
+        output = self.session(["echo never-run", "\x03",
+                               "echo after-interrupt\r"])
+        self.assertNotIn("\nnever-run", output.replace("\r", ""))
+        self.assertIn("\nafter-interrupt", output.replace("\r", ""))
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+"""Unit tests for the jshell --mcp tool server."""
+
+import json
+import os
+import subprocess
+import tempfile
+import unittest
+
+from tests.helpers import JShellRunner
+
+
+class TestMcpServer(unittest.TestCase):
+    """Test cases for MCP requests over stdin/stdout."""
+
+    def setUp(self):
+        """Start a server for the test."""
+        if not JShellRunner.exists():
+            self.skipTest(f"jshell binary not found at {JShellRunner.JSHELL}")
+        env = {**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
+        self.server = subprocess.Popen(
+            [str(JShellRunner.JSHELL), "--mcp"],
+            stdin=subprocess.PIPE,
+            stdout=subprocess.PIPE,
+            stderr=subprocess.DEVNULL,
+            text=True,
+            env=env
+        )
+        self.addCleanup(self.stop)
+        self.next_id = 0
+        try:
+            self.send('{"jsonrpc": "2.0", "id": 0, "method": "ping"}')
+            started = self.server.stdout.readline().startswith("{")
+        except BrokenPipeError:
+            started = False
+        if not started:
+            self.skipTest("jshell MCP server did not start")
+
+    def stop(self):
+        """Close stdin and wait for the server to exit."""
+        try:
+            self.server.stdin.close()
+        except BrokenPipeError:
+            pass
+        self.server.wait(timeout=5)
+        self.server.stdout.close()
+
+    def send(self, message):
+        """Write one raw line to the server."""
+        self.server.stdin.write(message + "\n")
+        self.server.stdin.flush()
+
+    def request(self, method, params=None):
+        """Send a request and return the decoded response."""
+        self.next_id += 1
+        message = {"jsonrpc": "2.0", "id": self.next_id, "method": method}
+        if params is not None:
+            message["params"] = params
+        self.send(json.dumps(message))
+        resp = json.loads(self.server.stdout.readline())
+        self.assertEqual(resp["id"], self.next_id)
+        return resp
+
+    def call(self, name, **arguments):
+        """Call a tool and return its result."""
+        resp = self.request("tools/call",
+                            {"name": name, "arguments": arguments})
+        self.assertIn("result", resp, resp)
+        return resp["result"]
+
+    def tools(self):
+        """Return the listed tools by name."""
+        resp = self.request("tools/list")
+        return {tool["name"]: tool for tool in resp["result"]["tools"]}
+
+    def test_initialize(self):
+        """Test the handshake announces the tools capability."""
+        resp = self.request("initialize", {
+            "protocolVersion": "2025-06-18",
+            "capabilities": {},
+            "clientInfo": {"name": "test", "version": "1"}
+        })
+        self.assertEqual(resp["result"]["protocolVersion"], "2025-06-18")
+        self.assertIn("tools", resp["result"]["capabilities"])
+        self.send('{"jsonrpc": "2.0", "method": "notifications/initialized"}')
+        self.assertEqual(self.request("ping")["result"], {})
+
+    def test_schemas_follow_argtables(self):
+        """Test input schemas are derived from the commands' argtables."""
+        tools = self.tools()
+        wc = tools["wc"]["inputSchema"]
+        self.assertEqual(wc["type"], "object")
+        self.assertEqual(wc["properties"]["lines"]["type"], "boolean")
+        self.assertEqual(wc["properties"]["json"]["default"], True)
+        self.assertEqual(wc["properties"]["file"]["type"], "array")
+        self.assertEqual(wc["properties"]["file"]["items"]["type"], "string")
+        self.assertNotIn("help", wc["properties"])
+        self.assertIn("n", tools["echo"]["inputSchema"]["properties"])
+
+    def test_call_returns_structured_json(self):
+        """Test --json output comes back as structuredContent."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = os.path.join(tmpdir, "f.txt")
+            with open(path, "w") as f:
+                f.write("a\nb\n")
+            result = self.call("wc", lines=True, file=[path])
+        self.assertFalse(result["isError"])
+        self.assertEqual(result["_meta"]["exit_status"], 0)
+        self.assertIsInstance(result["structuredContent"], dict)
+        self.assertEqual(json.loads(result["content"][0]["text"]),
+                         result["structuredContent"])
+
+    def test_call_argv_is_not_reparsed(self):
+        """Test arguments reach the command verbatim, dashes included."""
+        result = self.call("echo", n=True, text=["$HOME", "-x", "a  b"])
+        self.assertEqual(result["content"][0]["text"], "$HOME -x a  b")
+
+    def test_failed_command(self):
+        """Test a failing command is a tool error with its stderr."""
+        result = self.call("wc", file=["/nonexistent/file"], json=False)
+        self.assertTrue(result["isError"])
+        self.assertNotEqual(result["_meta"]["exit_status"], 0)
+        texts = " ".join(item["text"] for item in result["content"])
+        self.assertIn("/nonexistent/file", texts)
+
+    def test_errors(self):
+        """Test protocol errors are reported with JSON-RPC codes."""
+        self.assertEqual(self.request("no/such")["error"]["code"], -32601)
+        resp = self.request("tools/call", {"name": "no_such_tool"})
+        self.assertEqual(resp["error"]["code"], -32602)
+        resp = self.request("tools/call",
+                            {"name": "wc", "arguments": {"bogus": 1}})
+        self.assertEqual(resp["error"]["code"], -32602)
+        self.send("{not json")
+        resp = json.loads(self.server.stdout.readline())
+        self.assertEqual(resp["error"]["code"], -32700)
+
+
+if __name__ == "__main__":
+    unittest.main()
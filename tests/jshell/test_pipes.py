@@ -1,6 +1,9 @@
 #!/usr/bin/env python3
 """Unit tests for pipeline execution."""
 
+import json
+import os
+import tempfile
 import unittest
 
 from tests.helpers import JShellRunner
@@ -99,6 +102,18 @@ class TestPipelineExitCodes(unittest.TestCase):
         result = JShellRunner.run('echo "success" | cat')
         self.assertEqual(result.returncode, 0)
 
+    def test_missing_command_does_not_abort_pipeline(self):
+        """Test a stage that cannot be run does not stop the others."""
+        result = JShellRunner.run("_nonexistent_cmd_xyz | /bin/echo ok")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("ok", result.stdout)
+        self.assertIn("command not found", result.stderr)
+
+    def test_missing_last_command_exit_code(self):
+        """Test a missing last stage gives the pipeline status 127."""
+        result = JShellRunner.run("/bin/echo x | _nonexistent_cmd_xyz")
+        self.assertEqual(result.returncode, 127)
+
 
 class TestLargeDataPipeline(unittest.TestCase):
     """Test cases for pipeline with larger data."""
@@ -118,5 +133,107 @@ class TestLargeDataPipeline(unittest.TestCase):
         self.assertIn("x" * 100, result.stdout)
 
 
+
+class TestPipelineOptimizer(unittest.TestCase):
+    """Test cases for the pipeline peephole rewrites."""
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the jshell binary exists before running tests."""
+        if not JShellRunner.exists():
+            raise unittest.SkipTest(
+                f"jshell binary not found at {JShellRunner.JSHELL}")
+
+    def setUp(self):
+        self.tmp = tempfile.TemporaryDirectory()
+        self.path = os.path.join(self.tmp.name, "lines.txt")
+        with open(self.path, "w") as f:
+            f.write("".join(f"line {i}\n" for i in range(100)))
+
+    def tearDown(self):
+        self.tmp.cleanup()
+
+    def traced(self, command, env=None):
+        """Run a command with tracing; return it and its optimize events."""
+        trace_path = os.path.join(self.tmp.name, "trace.json")
+        result = JShellRunner.run(command,
+                                  env={"JSHELL_TRACE": trace_path,
+                                       **(env or {})})
+        with open(trace_path, encoding="utf-8") as f:
+            events = json.load(f)["traceEvents"]
+        rewrites = [event.get("args", {}).get("detail")
+                    for event in events if event["name"] == "optimize"]
+        return result, rewrites
+
+    def test_cat_into_rg_is_fused(self):
+        """Test cat FILE | rg gives the same lines as rg alone."""
+        result, rewrites = self.traced(f"cat {self.path} | rg 'line 4'")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout.split("\n")[:2], ["line 4", "line 40"])
+        self.assertIn("cat|rg", rewrites)
+
+    def test_cat_into_head_is_fused(self):
+        """Test cat FILE | head -n N prints the first N lines."""
+        result, rewrites = self.traced(f"cat {self.path} | head -n 2")
+        self.assertEqual(result.stdout.splitlines(), ["line 0", "line 1"])
+        self.assertIn("cat|head", rewrites)
+
+    def test_head_limit_pushed_into_rg(self):
+        """Test rg feeding head stops early with the same output."""
+        result, rewrites = self.traced(f"rg line {self.path} | head -n 3")
+        self.assertEqual(result.stdout.splitlines(),
+                         ["line 0", "line 1", "line 2"])
+        self.assertIn("head limit|rg", rewrites)
+
+    def test_missing_file_is_not_fused(self):
+        """Test cat of a missing file still reports the error itself."""
+        result, rewrites = self.traced("cat /nonexistent_xyz | head -n 1")
+        self.assertIn("cat", result.stderr)
+        self.assertEqual(rewrites, [])
+
+    def test_no_opt_disables_rewrites(self):
+        """Test JSHELL_NO_OPT=1 runs pipelines as written."""
+        result, rewrites = self.traced(f"cat {self.path} | head -n 1",
+                                       env={"JSHELL_NO_OPT": "1"})
+        self.assertEqual(result.stdout.strip(), "line 0")
+        self.assertEqual(rewrites, [])
+
+
+class TestPhaseTrace(unittest.TestCase):
+    """Test cases for JSHELL_TRACE phase timings."""
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the jshell binary exists before running tests."""
+        if not JShellRunner.exists():
+            raise unittest.SkipTest(
+                f"jshell binary not found at {JShellRunner.JSHELL}")
+
+    def test_trace_records_pipeline_phases(self):
+        """Test a traced pipeline writes parse, spawn and wait events."""
+        with tempfile.TemporaryDirectory() as tmp:
+            path = os.path.join(tmp, "trace.json")
+            result = JShellRunner.run("/bin/echo hi | /bin/cat",
+                                      env={"JSHELL_TRACE": path})
+            self.assertEqual(result.returncode, 0)
+            self.assertIn("hi", result.stdout)
+            with open(path, encoding="utf-8") as f:
+                trace = json.load(f)
+
+        names = {event["name"] for event in trace["traceEvents"]}
+        for phase in ("parse", "expand", "spawn", "wait", "pipeline"):
+            self.assertIn(phase, names)
+        for event in trace["traceEvents"]:
+            self.assertEqual(event["ph"], "X")
+            self.assertGreaterEqual(event["dur"], 0)
+
+    def test_no_trace_file_without_variable(self):
+        """Test nothing is written when JSHELL_TRACE is unset."""
+        with tempfile.TemporaryDirectory() as tmp:
+            result = JShellRunner.run("/bin/echo hi", cwd=tmp)
+            self.assertEqual(result.returncode, 0)
+            self.assertEqual(os.listdir(tmp), [])
+
+
 if __name__ == "__main__":
     unittest.main()
@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+"""Unit tests for the result cache of read-only commands."""
+
+import json
+import os
+import tempfile
+import unittest
+
+from tests.helpers import JShellRunner
+
+
+CACHE_ENV = {"JSHELL_RESULT_CACHE": "1M"}
+
+
+class TestResultCache(unittest.TestCase):
+    """Test cases for JSHELL_RESULT_CACHE."""
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the jshell binary exists before running tests."""
+        if not JShellRunner.exists():
+            raise unittest.SkipTest(
+                f"jshell binary not found at {JShellRunner.JSHELL}")
+
+    def setUp(self):
+        """Create a directory with one file."""
+        self.tmp = tempfile.TemporaryDirectory()
+        self.dir = self.tmp.name
+        with open(os.path.join(self.dir, "a.txt"), "w") as f:
+            f.write("alpha\n")
+
+    def tearDown(self):
+        """Remove the directory."""
+        self.tmp.cleanup()
+
+    def run_counted(self, commands, env=CACHE_ENV):
+        """Run commands, then return their output and the cache counters."""
+        result = JShellRunner.run(
+            f"stats -r > /dev/null; {commands}; stats --json",
+            env=env, cwd=self.dir)
+        self.assertEqual(result.returncode, 0, result.stderr)
+        lines = result.stdout.strip().split("\n")
+        return lines[:-1], json.loads(lines[-1])
+
+    def test_repeat_is_served_from_cache(self):
+        """Test the second identical run is a hit with the same output."""
+        lines, stats = self.run_counted("cat a.txt | cat; cat a.txt; cat a.txt")
+        self.assertEqual(lines, ["alpha", "alpha", "alpha"])
+        self.assertEqual(stats["result_cache_misses"], 1)
+        self.assertEqual(stats["result_cache_hits"], 1)
+
+    def test_new_file_invalidates_listing(self):
+        """Test a file created after a listing shows up in the next one."""
+        lines, stats = self.run_counted(
+            "ls; /bin/touch b.txt; ls")
+        self.assertEqual(lines, ["a.txt", "a.txt", "b.txt"])
+        self.assertEqual(stats["result_cache_hits"], 0)
+
+    def test_rewritten_file_invalidates(self):
+        """Test a file rewritten by another process is read again."""
+        lines, _ = self.run_counted(
+            "head a.txt; /bin/sh -c 'echo beta > a.txt'; head a.txt")
+        self.assertEqual(lines, ["alpha", "beta"])
+
+    def test_pattern_file_run_not_cached(self):
+        """Test rg -f sees a change to the path taken for PATTERN."""
+        with open(os.path.join(self.dir, "pats"), "w") as f:
+            f.write("alpha\n")
+        with open(os.path.join(self.dir, "b.txt"), "w") as f:
+            f.write("gamma\n")
+        lines, stats = self.run_counted(
+            "rg -f pats a.txt b.txt; /bin/sh -c 'echo alpha2 >> a.txt'; "
+            "rg -f pats a.txt b.txt")
+        self.assertEqual(lines, ["a.txt:alpha", "a.txt:alpha", "a.txt:alpha2"])
+        self.assertEqual(stats["result_cache_hits"], 0)
+
+    def test_change_below_tree(self):
+        """Test find sees a file created in a subdirectory."""
+        os.makedirs(os.path.join(self.dir, "sub", "deep"))
+        lines, _ = self.run_counted(
+            "find sub --type f; /bin/touch sub/deep/c; find sub --type f")
+        self.assertEqual(lines, ["sub/deep/c"])
+
+    def test_stdin_not_cached(self):
+        """Test commands reading standard input always run."""
+        _, stats = self.run_counted("wc -l < a.txt; wc -l < a.txt")
+        self.assertEqual(stats["result_cache_hits"], 0)
+        self.assertEqual(stats["result_cache_misses"], 0)
+
+    def test_disabled_by_default(self):
+        """Test nothing is cached without JSHELL_RESULT_CACHE."""
+        _, stats = self.run_counted("cat a.txt; cat a.txt", env=None)
+        self.assertEqual(stats["result_cache_hits"], 0)
+        self.assertEqual(stats["result_cache_misses"], 0)
+
+    def test_invalid_size(self):
+        """Test an invalid size is reported and leaves the cache off."""
+        result = JShellRunner.run("cat a.txt", cwd=self.dir,
+                                  env={"JSHELL_RESULT_CACHE": "lots"})
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("ignoring invalid JSHELL_RESULT_CACHE", result.stderr)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+"""Unit tests for the jshell --serve socket server."""
+
+import json
+import os
+import socket
+import subprocess
+import tempfile
+import time
+import unittest
+
+from tests.helpers import JShellRunner
+
+
+class TestShellServer(unittest.TestCase):
+    """Test cases for JSON command requests over a Unix socket."""
+
+    @classmethod
+    def setUpClass(cls):
+        """Start a server on a temporary socket."""
+        if not JShellRunner.exists():
+            raise unittest.SkipTest(
+                f"jshell binary not found at {JShellRunner.JSHELL}")
+        cls.tmpdir = tempfile.TemporaryDirectory()
+        cls.sock_path = os.path.join(cls.tmpdir.name, "jshell.sock")
+        env = {**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
+        cls.server = subprocess.Popen(
+            [str(JShellRunner.JSHELL), "--serve", cls.sock_path],
+            stdin=subprocess.DEVNULL,
+            stdout=subprocess.DEVNULL,
+            stderr=subprocess.DEVNULL,
+            env=env
+        )
+        deadline = time.monotonic() + 5
+        while not os.path.exists(cls.sock_path):
+            if time.monotonic() > deadline or cls.server.poll() is not None:
+                cls.server.kill()
+                raise unittest.SkipTest("jshell server did not start")
+            time.sleep(0.05)
+
+    @classmethod
+    def tearDownClass(cls):
+        """Stop the server and remove the socket directory."""
+        cls.server.terminate()
+        cls.server.wait(timeout=5)
+        cls.tmpdir.cleanup()
+
+    def connect(self):
+        """Open a client connection as a line-oriented file."""
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        sock.settimeout(10)
+        sock.connect(self.sock_path)
+        self.addCleanup(sock.close)
+        return sock.makefile("rw")
+
+    def request(self, conn, **fields):
+        """Send one request and return the decoded response."""
+        conn.write(json.dumps(fields) + "\n")
+        conn.flush()
+        return json.loads(conn.readline())
+
+    def test_command_output_and_status(self):
+        """Test stdout, stderr and exit status come back separately."""
+        conn = self.connect()
+        resp = self.request(conn, id=1, command="echo hello; false")
+        self.assertEqual(resp["id"], 1)
+        self.assertEqual(resp["status"], "ok")
+        self.assertEqual(resp["exit_status"], 1)
+        self.assertEqual(resp["stdout"], "hello\n")
+
+        resp = self.request(conn, command="nonexistent_command_xyz")
+        self.assertEqual(resp["exit_status"], 127)
+        self.assertIn("nonexistent_command_xyz", resp["stderr"])
+
+    def test_cwd_and_env_per_connection(self):
+        """Test cwd/env apply to the connection and not to other clients."""
+        first = self.connect()
+        resp = self.request(first, command="pwd; echo $SERVE_VAR",
+                            cwd="/tmp", env={"SERVE_VAR": "set"})
+        self.assertEqual(resp["stdout"].split(), ["/tmp", "set"])
+
+        resp = self.request(first, command="echo $SERVE_VAR")
+        self.assertEqual(resp["stdout"].strip(), "set")
+
+        second = self.connect()
+        resp = self.request(second, command="echo $SERVE_VAR")
+        self.assertEqual(resp["stdout"].strip(), "")
+
+    def test_malformed_request(self):
+        """Test a bad request gets an error and keeps the connection."""
+        conn = self.connect()
+        conn.write("not json\n")
+        conn.flush()
+        resp = json.loads(conn.readline())
+        self.assertEqual(resp["status"], "error")
+
+        resp = self.request(conn, command="echo still-open")
+        self.assertEqual(resp["stdout"], "still-open\n")
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -1,8 +1,12 @@
 #!/usr/bin/env python3
 """Unit tests for shell session functionality."""
 
+import json
 import os
+import subprocess
 import tempfile
+import threading
+import time
 import unittest
 
 from tests.helpers import JShellRunner
@@ -110,6 +114,69 @@ class TestBackgroundJobs(unittest.TestCase):
         self.assertEqual(result.returncode, 0)
         self.assertIn("[", result.stdout)  # JSON array
 
+    def test_more_than_one_hundred_jobs(self):
+        """Test the job table grows past the old 100-job limit."""
+        command = "; ".join(["sleep 0.2 &"] * 120) + "; jobs; wait"
+        result = JShellRunner.run(command, timeout=30)
+        self.assertEqual(result.returncode, 0)
+        self.assertNotIn("job table full", result.stderr)
+        self.assertIn("[120]", result.stdout)
+
+    def test_wait_reports_last_stage_status(self):
+        """Test wait returns the status of a job's last process."""
+        result = JShellRunner.run("sleep 0.1 | false &; wait %1")
+        self.assertNotEqual(result.returncode, 0)
+
+    def test_wait_any_returns_first_finished(self):
+        """Test wait -n returns as soon as the first listed job finishes."""
+        start = time.monotonic()
+        result = JShellRunner.run(
+            "sleep 5 &; sh -c 'sleep 0.1; exit 3' &; "
+            "wait -n --json %1 %2; kill %1", timeout=10)
+        self.assertLess(time.monotonic() - start, 4)
+        self.assertIn('{"job": 2, "status": "exited", "code": 3}',
+                      result.stdout)
+
+    def test_wait_several_jobs(self):
+        """Test wait with several job IDs waits for all of them."""
+        result = JShellRunner.run(
+            "sh -c 'exit 4' &; sleep 0.2 &; wait --json %1 %2")
+        self.assertEqual(result.returncode, 0)
+        jobs = json.loads(result.stdout[result.stdout.index("{"):])["jobs"]
+        self.assertEqual([job["code"] for job in jobs], [4, 0])
+
+    def test_background_builtin_is_a_job(self):
+        """Test a builtin started with & runs detached as a job."""
+        start = time.monotonic()
+        result = JShellRunner.run(
+            "parallel sleep ::: 0.5 &; echo launched; jobs; wait %1; "
+            "echo status=$?", timeout=10)
+        self.assertEqual(result.returncode, 0)
+        lines = result.stdout.splitlines()
+        self.assertIn("launched", lines)
+        self.assertTrue(any("Running" in line and "parallel" in line
+                            for line in lines))
+        self.assertIn("status=0", lines)
+        self.assertGreaterEqual(time.monotonic() - start, 0.4)
+
+    def test_kill_background_builtin(self):
+        """Test kill stops a background builtin through its job."""
+        start = time.monotonic()
+        result = JShellRunner.run(
+            "parallel sleep ::: 5 5 &; kill %1; wait %1", timeout=10)
+        self.assertLess(time.monotonic() - start, 4)
+        self.assertNotEqual(result.returncode, 0)
+
+    def test_wait_timeout(self):
+        """Test wait --timeout gives up with status 124."""
+        start = time.monotonic()
+        result = JShellRunner.run(
+            "sleep 5 &; wait --timeout 0.2 --json %1; echo status=$?; "
+            "kill %1", timeout=10)
+        self.assertLess(time.monotonic() - start, 4)
+        self.assertIn('"status": "timeout"', result.stdout)
+        self.assertIn("status=124", result.stdout)
+
 
 class TestCommandHistory(unittest.TestCase):
     """Test cases for command history."""
@@ -127,6 +194,143 @@ class TestCommandHistory(unittest.TestCase):
         # History command should succeed
         self.assertEqual(result.returncode, 0)
 
+    def run_interactive(self, lines, home):
+        """Feed lines to an interactive jshell with HOME set to home."""
+        env = {**os.environ, "ASAN_OPTIONS": "detect_leaks=0", "HOME": home}
+        result = subprocess.run(
+            [str(JShellRunner.JSHELL)],
+            input="\n".join(lines) + "\n",
+            capture_output=True,
+            text=True,
+            env=env,
+            timeout=10
+        )
+        return JShellRunner._clean_output(result.stdout)
+
+    def test_history_persists_across_sessions(self):
+        """Test commands from an earlier session are listed."""
+        with tempfile.TemporaryDirectory() as home:
+            self.run_interactive(["echo first-session-marker"], home)
+            output = self.run_interactive(["history"], home)
+            self.assertIn("echo first-session-marker", output)
+            self.assertTrue(os.path.exists(
+                os.path.join(home, ".jshell", "history")))
+
+    def test_history_search(self):
+        """Test --search only lists matching commands."""
+        with tempfile.TemporaryDirectory() as home:
+            output = self.run_interactive([
+                "echo alpha-marker",
+                "echo beta-marker",
+                "history --search alpha-mark",
+            ], home)
+            self.assertIn("echo alpha-marker", output)
+            self.assertNotIn("echo beta-marker", output)
+
+    def test_history_json_records_status(self):
+        """Test JSON output carries the exit status of finished commands."""
+        with tempfile.TemporaryDirectory() as home:
+            self.run_interactive(["false"], home)
+            output = self.run_interactive(["history --json"], home)
+            self.assertIn('"command": "false"', output)
+            self.assertIn('"exit_status": 1', output)
+
+    def test_history_shared_with_running_session(self):
+        """Test a command is visible to another session while its own runs."""
+        with tempfile.TemporaryDirectory() as home:
+            env = {**os.environ, "ASAN_OPTIONS": "detect_leaks=0",
+                   "HOME": home}
+            first = subprocess.Popen(
+                [str(JShellRunner.JSHELL)],
+                stdin=subprocess.PIPE,
+                stdout=subprocess.DEVNULL,
+                stderr=subprocess.DEVNULL,
+                text=True,
+                env=env
+            )
+            try:
+                first.stdin.write("echo running-session-marker\n")
+                first.stdin.flush()
+                output = ""
+                deadline = time.monotonic() + 5
+                while ("running-session-marker" not in output
+                       and time.monotonic() < deadline):
+                    time.sleep(0.1)
+                    output = self.run_interactive(
+                        ["history --search running-session"], home)
+                self.assertIn("echo running-session-marker", output)
+            finally:
+                first.stdin.close()
+                first.wait(timeout=10)
+
+    def test_history_concurrent_sessions_keep_every_entry(self):
+        """Test two sessions appending at once lose and reorder nothing."""
+        count = 300
+        with tempfile.TemporaryDirectory() as home:
+            env = {**os.environ, "ASAN_OPTIONS": "detect_leaks=0",
+                   "HOME": home}
+            paths = [os.path.join(home, ".jshell", name)
+                     for name in ("history", "history.idx")]
+            sessions = [subprocess.Popen(
+                [str(JShellRunner.JSHELL)],
+                stdin=subprocess.PIPE,
+                stdout=subprocess.DEVNULL,
+                stderr=subprocess.DEVNULL,
+                text=True,
+                env=env
+            ) for _ in range(2)]
+            writers = [threading.Thread(target=self.feed_lines, args=(
+                session, [f"echo concurrent-{name}-{i:04d}"
+                          for i in range(count)]))
+                       for session, name in zip(sessions, "ab")]
+            for writer in writers:
+                writer.start()
+
+            # Sample the file sizes until both sessions are done
+            sizes = {path: 0 for path in paths}
+            while any(session.poll() is None for session in sessions):
+                for path in paths:
+                    try:
+                        size = os.path.getsize(path)
+                    except FileNotFoundError:
+                        continue
+                    self.assertGreaterEqual(size, sizes[path],
+                                            f"{path} was truncated")
+                    sizes[path] = size
+                time.sleep(0.005)
+            for writer in writers:
+                writer.join()
+            for session in sessions:
+                self.assertEqual(session.wait(), 0)
+
+            output = self.run_interactive(["history --json"], home)
+            history = json.loads(output[output.index("{"):])["history"]
+            commands = [entry["command"] for entry in history]
+            for name in "ab":
+                mine = [c for c in commands
+                        if c.startswith(f"echo concurrent-{name}-")]
+                self.assertEqual(mine, [f"echo concurrent-{name}-{i:04d}"
+                                        for i in range(count)])
+
+    @staticmethod
+    def feed_lines(session, lines):
+        """Write lines to a session one at a time, then close its stdin."""
+        for line in lines:
+            session.stdin.write(line + "\n")
+            session.stdin.flush()
+        session.stdin.close()
+
+    def test_history_skips_torn_record(self):
+        """Test garbage left by a crashed session does not hide later ones."""
+        with tempfile.TemporaryDirectory() as home:
+            self.run_interactive(["echo before-crash-marker"], home)
+            with open(os.path.join(home, ".jshell", "history"), "ab") as f:
+                f.write(b"RRHJ\x40\x00\x00\x00torn")
+            self.run_interactive(["echo after-crash-marker"], home)
+            output = self.run_interactive(["history"], home)
+            self.assertIn("echo before-crash-marker", output)
+            self.assertIn("echo after-crash-marker", output)
+
 
 class TestShellEnvironment(unittest.TestCase):
     """Test cases for shell environment handling."""
@@ -199,5 +403,204 @@ class TestMultipleCommands(unittest.TestCase):
             os.unlink(temp_path)
 
 
+class TestRepeatedInteractiveLines(unittest.TestCase):
+    """Test cases for repeated lines reusing cached parse trees."""
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the jshell binary exists before running tests."""
+        if not JShellRunner.exists():
+            raise unittest.SkipTest(
+                f"jshell binary not found at {JShellRunner.JSHELL}")
+
+    def run_interactive(self, lines):
+        """Feed lines to an interactive jshell and return its stdout."""
+        env = {**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
+        result = subprocess.run(
+            [str(JShellRunner.JSHELL)],
+            input="\n".join(lines) + "\n",
+            capture_output=True,
+            text=True,
+            env=env,
+            timeout=10
+        )
+        return JShellRunner._clean_output(result.stdout)
+
+    def test_repeated_line_is_re_evaluated(self):
+        """Test a repeated line sees the current shell state."""
+        output = self.run_interactive([
+            'export "REPEAT_VAR=first"',
+            "echo $REPEAT_VAR",
+            'export "REPEAT_VAR=second"',
+            "echo $REPEAT_VAR",
+        ])
+        self.assertIn("first", output)
+        self.assertIn("second", output)
+
+    def test_repeated_line_after_cd(self):
+        """Test the same pwd line reports each new directory."""
+        output = self.run_interactive(["cd /tmp", "pwd", "cd /", "pwd"])
+        self.assertIn("/tmp", output)
+        self.assertTrue(any(line.endswith(">/")
+                            for line in output.splitlines()))
+
+    def test_repeated_redirected_pipeline(self):
+        """Test a repeated multi-job line with a pipe and redirection."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            out_path = os.path.join(tmpdir, "out.txt")
+            line = f"echo one | cat > {out_path}; cat {out_path}"
+            output = self.run_interactive([line, line])
+            self.assertEqual(output.count("one"), 2)
+
+
+class TestScriptMode(unittest.TestCase):
+    """Test cases for running scripts and -s command streams."""
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the jshell binary exists before running tests."""
+        if not JShellRunner.exists():
+            raise unittest.SkipTest(
+                f"jshell binary not found at {JShellRunner.JSHELL}")
+
+    def run_jshell(self, args, stdin=""):
+        """Run jshell with args, feeding stdin, and return the result."""
+        env = {**os.environ, "ASAN_OPTIONS": "detect_leaks=0"}
+        return subprocess.run(
+            [str(JShellRunner.JSHELL), *args],
+            input=stdin,
+            capture_output=True,
+            text=True,
+            env=env,
+            timeout=10
+        )
+
+    def test_script_file(self):
+        """Test a script runs every command without a prompt."""
+        with tempfile.TemporaryDirectory() as tmpdir:
+            script = os.path.join(tmpdir, "test.jsh")
+            with open(script, "w") as f:
+                f.write("#!/usr/bin/env jshell\n"
+                        "# a comment\n"
+                        "\n"
+                        'export "SCRIPT_VAR=kept"\n'
+                        "echo $SCRIPT_VAR\n"
+                        "echo con \\\n"
+                        "  tinued\n")
+            result = self.run_jshell([script])
+            self.assertEqual(result.returncode, 0)
+            self.assertNotIn("(jsh)>", result.stdout)
+            self.assertEqual(result.stdout.split(), ["kept", "con", "tinued"])
+
+    def test_stdin_stream(self):
+        """Test -s runs commands from stdin and returns the last status."""
+        result = self.run_jshell(["-s"], "echo one\necho two\nfalse\n")
+        self.assertEqual(result.stdout.split(), ["one", "two"])
+        self.assertEqual(result.returncode, 1)
+
+    def test_exit_stops_script(self):
+        """Test exit N ends the script with status N."""
+        result = self.run_jshell(["-s"], "echo before\nexit 3\necho after\n")
+        self.assertEqual(result.returncode, 3)
+        self.assertIn("before", result.stdout)
+        self.assertNotIn("after", result.stdout)
+
+    def test_parse_error_reports_line(self):
+        """Test a parse error stops the script and names the line."""
+        result = self.run_jshell(["-s"], "echo ok\necho <\necho never\n")
+        self.assertEqual(result.returncode, 1)
+        self.assertIn("stdin:2", result.stderr)
+        self.assertNotIn("never", result.stdout)
+
+    def test_missing_script(self):
+        """Test a missing script file fails with status 127."""
+        result = self.run_jshell(["/nonexistent/script.jsh"])
+        self.assertEqual(result.returncode, 127)
+
+
+class TestScriptCache(unittest.TestCase):
+    """Test cases for compiled scripts in ~/.jshell/cache."""
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the jshell binary exists before running tests."""
+        if not JShellRunner.exists():
+            raise unittest.SkipTest(
+                f"jshell binary not found at {JShellRunner.JSHELL}")
+
+    def run_script(self, home, text, **env_extra):
+        """Write text to a script in home and run it with HOME=home."""
+        script = os.path.join(home, "test.jsh")
+        with open(script, "w") as f:
+            f.write(text)
+        env = {**os.environ, "ASAN_OPTIONS": "detect_leaks=0",
+               "HOME": home, **env_extra}
+        return subprocess.run(
+            [str(JShellRunner.JSHELL), script],
+            capture_output=True,
+            text=True,
+            env=env,
+            cwd=home,
+            timeout=10
+        )
+
+    def compiled(self, home):
+        """List the compiled scripts in home's cache."""
+        cache = os.path.join(home, ".jshell", "cache")
+        if not os.path.isdir(cache):
+            return []
+        return [n for n in os.listdir(cache) if n.endswith(".jshc")]
+
+    def test_second_run_uses_compiled_script(self):
+        """Test a script is compiled on its first run and runs the same."""
+        text = ("X=one\n"
+                "echo $X two | rg two > out.txt\n"
+                "echo 'lit' \"exp\" < out.txt\n"
+                "exit 4\n"
+                "echo never\n")
+        with tempfile.TemporaryDirectory() as home:
+            first = self.run_script(home, text)
+            self.assertEqual(len(self.compiled(home)), 1)
+            second = self.run_script(home, text)
+            self.assertEqual(first.stdout, second.stdout)
+            self.assertEqual(second.returncode, 4)
+            self.assertNotIn("never", second.stdout)
+
+    def test_edited_script_is_recompiled(self):
+        """Test a changed script runs its new text."""
+        with tempfile.TemporaryDirectory() as home:
+            self.run_script(home, "echo old\n")
+            result = self.run_script(home, "echo new\n")
+            self.assertEqual(result.stdout.strip(), "new")
+            self.assertEqual(len(self.compiled(home)), 2)
+
+    def test_parse_error_is_not_compiled(self):
+        """Test a script stopped by a parse error is not cached."""
+        with tempfile.TemporaryDirectory() as home:
+            result = self.run_script(home, "echo ok\necho <\n")
+            self.assertEqual(result.returncode, 1)
+            self.assertEqual(self.compiled(home), [])
+
+    def test_damaged_compiled_script_is_ignored(self):
+        """Test a damaged .jshc file falls back to parsing."""
+        with tempfile.TemporaryDirectory() as home:
+            self.run_script(home, "echo fine\n")
+            path = os.path.join(home, ".jshell", "cache",
+                                self.compiled(home)[0])
+            with open(path, "r+b") as f:
+                f.seek(80)
+                f.write(b"\xff" * 16)
+            result = self.run_script(home, "echo fine\n")
+            self.assertEqual(result.stdout.strip(), "fine")
+
+    def test_cache_can_be_turned_off(self):
+        """Test JSHELL_NO_SCRIPT_CACHE=1 writes no compiled script."""
+        with tempfile.TemporaryDirectory() as home:
+            result = self.run_script(home, "echo off\n",
+                                     JSHELL_NO_SCRIPT_CACHE="1")
+            self.assertEqual(result.stdout.strip(), "off")
+            self.assertEqual(self.compiled(home), [])
+
+
 if __name__ == "__main__":
     unittest.main()
@@ -2,6 +2,11 @@
 """Unit tests for threaded builtin execution."""
 
 import json
+import os
+import subprocess
+import tempfile
+import threading
+import time
 import unittest
 
 from tests.helpers import JShellRunner
@@ -144,5 +149,169 @@ class TestConcurrentBuiltins(unittest.TestCase):
         self.assertIn("done", result.stdout)
 
 
+class TestInProcessPipelineStages(unittest.TestCase):
+    """Test cases for builtins running on threads inside pipelines."""
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the jshell binary exists before running tests."""
+        if not JShellRunner.exists():
+            raise unittest.SkipTest(
+                f"jshell binary not found at {JShellRunner.JSHELL}")
+
+    def test_builtin_first_stage(self):
+        """Test a threaded builtin feeding an external stage."""
+        result = JShellRunner.run("help | cat")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("pwd", result.stdout)
+
+    def test_builtin_middle_stage(self):
+        """Test a threaded builtin between two external stages."""
+        result = JShellRunner.run("/bin/echo ignored | type cd | cat")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("cd is a shell builtin", result.stdout)
+
+    def test_builtin_last_stage_exit_code(self):
+        """Test the pipeline status comes from a threaded last stage."""
+        result = JShellRunner.run(
+            "/bin/echo x | type _nonexistent_cmd_xyz; echo $?")
+        self.assertIn("1", result.stdout.split())
+
+    def test_state_builtin_in_pipeline_keeps_subshell_semantics(self):
+        """Test cd in a pipeline does not change the shell's directory."""
+        result = JShellRunner.run("cd /; cd /tmp | cat; pwd")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout.strip().splitlines()[-1], "/")
+
+    def test_builtin_job_keeps_directory_after_cd(self):
+        """Test a cd while a builtin job runs does not move the job."""
+        with tempfile.TemporaryDirectory() as base:
+            dirs = {}
+            for name in ("a", "b"):
+                dirs[name] = os.path.join(base, name)
+                os.mkdir(dirs[name])
+                with open(os.path.join(dirs[name], "f"), "w") as f:
+                    f.write(f"from-{name}\n")
+            fifo = os.path.join(base, "names")
+            os.mkfifo(fifo)
+
+            def feed():
+                # xargs is a background builtin job: its thread only
+                # reads the relative name once the shell has run cd
+                with open(fifo, "w") as f:
+                    time.sleep(0.5)
+                    f.write("f\n")
+
+            writer = threading.Thread(target=feed)
+            writer.start()
+            result = JShellRunner.run(
+                f"cd {dirs['a']}; xargs cat < {fifo} & "
+                f"cd {dirs['b']}; wait", timeout=10)
+            writer.join()
+            self.assertIn("from-a", result.stdout)
+            self.assertNotIn("from-b", result.stdout)
+
+    def test_two_builtin_stages(self):
+        """Test two threaded builtins connected to each other."""
+        result = JShellRunner.run("pwd | type cd | cat")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("cd is a shell builtin", result.stdout)
+
+    def test_builtin_feeding_builtin_json(self):
+        """Test each builtin thread writes to its own stream."""
+        data = JShellRunner.run_json("help | pwd --json")
+        self.assertIn("cwd", data)
+
+    def test_builtin_reads_builtin_over_ring(self):
+        """Test a builtin reading lines written by the builtin before it."""
+        result = JShellRunner.run("type cd pwd | parallel echo seen:{}")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("seen:cd is a shell builtin", result.stdout)
+        self.assertIn("seen:pwd is a shell builtin", result.stdout)
+
+    def test_builtin_chain_ignoring_input_finishes(self):
+        """Test writers finish when the builtin after them never reads."""
+        result = JShellRunner.run("help | help | help | type cd")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout.strip(), "cd is a shell builtin")
+
+    def test_upstream_stops_once_head_exits(self):
+        """Test stages feeding an exited head are cancelled, not drained."""
+        with tempfile.TemporaryDirectory() as tmp:
+            path = os.path.join(tmp, "huge.txt")
+            with open(path, "w") as f:
+                f.write("match\n" + "skip line\n" * 2000000)
+            result = JShellRunner.run(
+                f"rg match {path} | head -n 1; echo after")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout.split(), ["match", "after"])
+
+    def test_shell_usable_after_builtin_pipeline(self):
+        """Test stdout is restored after a threaded pipeline stage."""
+        result = JShellRunner.run("pwd | cat; echo after")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("after", result.stdout)
+
+
+class TestLinkedApps(unittest.TestCase):
+    """Test cases for apps linked into the jbox binary."""
+
+    @classmethod
+    def setUpClass(cls):
+        """Verify the jshell binary exists before running tests."""
+        if not JShellRunner.exists():
+            raise unittest.SkipTest(
+                f"jshell binary not found at {JShellRunner.JSHELL}")
+
+    def test_app_runs_through_symlink(self):
+        """Test jbox dispatches on the name it is run as."""
+        ls_link = JShellRunner.JSHELL.parent / "ls"
+        if not ls_link.exists():
+            self.skipTest(f"{ls_link} not found")
+        with tempfile.TemporaryDirectory() as tmp:
+            open(os.path.join(tmp, "marker.txt"), "w").close()
+            result = subprocess.run([str(ls_link), tmp], capture_output=True,
+                                    text=True, timeout=10)
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("marker.txt", result.stdout)
+
+    def test_app_is_registered_without_install(self):
+        """Test linked apps are known to the shell without pkg install."""
+        result = JShellRunner.run("type rg")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("rg is a shell external", result.stdout)
+
+    def test_app_as_pipeline_stage(self):
+        """Test a linked app feeding another stage."""
+        with tempfile.TemporaryDirectory() as tmp:
+            open(os.path.join(tmp, "marker.txt"), "w").close()
+            result = JShellRunner.run(f"ls {tmp} | cat")
+        self.assertEqual(result.returncode, 0)
+        self.assertIn("marker.txt", result.stdout)
+
+    def test_app_redirected_to_file(self):
+        """Test a linked app writing to a file, then the shell's stdout."""
+        with tempfile.TemporaryDirectory() as tmp:
+            out_path = os.path.join(tmp, "out.txt")
+            result = JShellRunner.run(
+                f"echo one > {out_path}; cat {out_path} | cat; echo after")
+            with open(out_path) as f:
+                self.assertEqual(f.read().strip(), "one")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout.split(), ["one", "after"])
+
+    def test_several_apps_in_one_pipeline(self):
+        """Test linked apps running side by side as pipeline stages."""
+        with tempfile.TemporaryDirectory() as tmp:
+            path = os.path.join(tmp, "lines.txt")
+            with open(path, "w") as f:
+                f.write("".join(f"line {i}\n" for i in range(5000)))
+            result = JShellRunner.run(
+                f"cat {path} | rg 'line 4' | head -n 3 | cat")
+        self.assertEqual(result.returncode, 0)
+        self.assertEqual(result.stdout.splitlines(),
+                         ["line 4", "line 40", "line 41"])
+
+
 if __name__ == "__main__":
     unittest.main()
@@ -158,7 +158,8 @@ class PkgTestBase(unittest.TestCase):
                             version: str = "1.0.0",
                             description: Optional[str] = None,
                             files: Optional[list] = None,
-                            with_source: bool = False) -> Path:
+                            with_source: bool = False,
+                            dependencies: Optional[list] = None) -> Path:
         """Create a test package directory with pkg.json.
 
         Args:
@@ -167,6 +168,7 @@ class PkgTestBase(unittest.TestCase):
             description: Package description (default: auto-generated)
             files: List of files to include (default: ["bin/<name>"])
             with_source: Include source files for compilation
+            dependencies: Names of packages to build first (default: none)
 
         Returns:
             Path to the package directory (caller must clean up parent tmpdir)
@@ -195,6 +197,8 @@ class PkgTestBase(unittest.TestCase):
             "description": description or f"Test package {name}",
             "files": files
         }
+        if dependencies is not None:
+            manifest["dependencies"] = dependencies
 
         if with_source:
             # Create minimal source structure
@@ -399,10 +403,26 @@ clean:
             For txt: {"packages": [{"name": ..., "version": ...}, ...]}
         """
         json_path = self.JSHELL_HOME / "pkgs" / "pkgdb.json"
+        journal_path = self.JSHELL_HOME / "pkgs" / "pkgdb.journal"
         txt_path = self.JSHELL_HOME / "pkgdb.txt"
 
         if json_path.exists():
-            return json.loads(json_path.read_text())
+            data = json.loads(json_path.read_text())
+            if journal_path.exists():
+                # Replay the changes made since the snapshot
+                packages = {p["name"]: p for p in data["packages"]}
+                for line in journal_path.read_text().splitlines():
+                    try:
+                        record = json.loads(line)
+                    except ValueError:
+                        continue
+                    if record.get("op") == "remove":
+                        packages.pop(record.get("name"), None)
+                    elif record.get("op") == "add":
+                        del record["op"]
+                        packages[record["name"]] = record
+                data["packages"] = list(packages.values())
+            return data
 
         if txt_path.exists():
             packages = []
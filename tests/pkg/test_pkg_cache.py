@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""Tests for tarball checksums and the download cache of pkg install."""
+
+import hashlib
+import shutil
+import tempfile
+import unittest
+from pathlib import Path
+
+from tests.pkg import PkgRegistryTestBase
+
+
+class TestPkgDownloadCache(PkgRegistryTestBase):
+    """Test sha256 verification and ~/.jshell/cache with the registry."""
+
+    PACKAGE = "ls"
+
+    def setUp(self):
+        """Skip unless the registry lists the package with a checksum."""
+        super().setUp()
+        self.tarballs = sorted(self.DOWNLOADS_DIR.glob(
+            f"{self.PACKAGE}-*.tar.gz"))
+        if not self.tarballs:
+            self.skipTest(f"No {self.PACKAGE} tarball in {self.DOWNLOADS_DIR}")
+
+    def cache_entries(self) -> list:
+        """Return the tarballs in the download cache."""
+        return sorted((self.JSHELL_HOME / "cache").glob("*.tar.gz"))
+
+    def install_and_remove(self) -> Path:
+        """Install the package, remove it, and return its cache entry."""
+        result = self.run_pkg("install", self.PACKAGE, timeout=120)
+        self.assertEqual(result.returncode, 0, result.stderr)
+        self.assertPackageInstalled(self.PACKAGE)
+        entries = self.cache_entries()
+        self.assertEqual(len(entries), 1, "Expected one cached tarball")
+        result = self.run_pkg("remove", self.PACKAGE)
+        self.assertEqual(result.returncode, 0, result.stderr)
+        return entries[0]
+
+    def test_checksum_mismatch_fails_install(self):
+        """Test a tarball not matching its sha256 installs nothing."""
+        backup = Path(tempfile.mkdtemp())
+        try:
+            # Same names, other bytes: the registry still lists the old
+            # digests
+            for tarball in self.tarballs:
+                shutil.copy2(tarball, backup / tarball.name)
+                tarball.write_bytes(b"not the tarball\n" * 64)
+            result = self.run_pkg("install", self.PACKAGE, timeout=120)
+        finally:
+            for tarball in self.tarballs:
+                shutil.copy2(backup / tarball.name, tarball)
+            shutil.rmtree(backup)
+        self.assertNotEqual(result.returncode, 0)
+        self.assertIn("checksum mismatch", result.stderr)
+        self.assertPackageNotInstalled(self.PACKAGE)
+        self.assertBinaryNotExists(self.PACKAGE)
+        self.assertEqual(self.cache_entries(), [])
+
+    def test_second_install_served_from_cache(self):
+        """Test installing again unpacks the cached tarball."""
+        entry = self.install_and_remove()
+        digest = hashlib.sha256(entry.read_bytes()).hexdigest()
+        self.assertEqual(entry.name, f"{digest}.tar.gz")
+
+        result = self.run_pkg("install", self.PACKAGE, timeout=120)
+        self.assertEqual(result.returncode, 0, result.stderr)
+        self.assertIn("Using cached", result.stdout)
+        self.assertNotIn("Downloading", result.stdout)
+        self.assertPackageInstalled(self.PACKAGE)
+        self.assertBinaryExists(self.PACKAGE)
+
+    def test_corrupt_cache_entry_downloaded_again(self):
+        """Test a damaged cache entry is dropped and fetched again."""
+        entry = self.install_and_remove()
+        good = entry.read_bytes()
+        entry.write_bytes(good[:len(good) // 2])
+
+        result = self.run_pkg("install", self.PACKAGE, timeout=120)
+        self.assertEqual(result.returncode, 0, result.stderr)
+        self.assertNotIn("Using cached", result.stdout)
+        self.assertIn("Downloading", result.stdout)
+        self.assertPackageInstalled(self.PACKAGE)
+        self.assertEqual(self.cache_entries(), [entry])
+        self.assertEqual(entry.read_bytes(), good)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -166,6 +166,74 @@ class TestPkgDbJson(PkgTestBase):
         old_path = self.JSHELL_HOME / "pkgdb.json"
         self.assertFalse(old_path.exists())
 
+    def test_later_changes_go_to_journal(self):
+        """Test that changes after the first snapshot are appended to the journal."""
+        self.install_test_package("pkg-a", "1.0.0")
+        json_path = self.JSHELL_HOME / "pkgs" / "pkgdb.json"
+        snapshot = json_path.read_text()
+
+        self.install_test_package("pkg-b", "2.0.0")
+        result = self.run_pkg("remove", "pkg-a")
+        self.assertEqual(result.returncode, 0)
+
+        # The snapshot is untouched; the journal holds one record per change
+        self.assertEqual(json_path.read_text(), snapshot)
+        journal = self.JSHELL_HOME / "pkgs" / "pkgdb.journal"
+        records = [json.loads(line)
+                   for line in journal.read_text().splitlines()]
+        self.assertEqual([(r["op"], r["name"]) for r in records],
+                         [("add", "pkg-b"), ("remove", "pkg-a")])
+
+        result = self.run_pkg("list", "--json")
+        data = json.loads(result.stdout)
+        self.assertEqual([p["name"] for p in data["packages"]], ["pkg-b"])
+
+    def test_torn_journal_record_ignored(self):
+        """Test that a journal record cut short by a crash is skipped."""
+        self.install_test_package("pkg-a", "1.0.0")
+        self.install_test_package("pkg-b", "2.0.0")
+        journal = self.JSHELL_HOME / "pkgs" / "pkgdb.journal"
+        with open(journal, "a") as f:
+            f.write('{"op": "remove", "name": "pk')
+
+        result = self.run_pkg("list", "--json")
+        data = json.loads(result.stdout)
+        self.assertEqual({p["name"] for p in data["packages"]},
+                         {"pkg-a", "pkg-b"})
+
+        # Later records still land on lines of their own
+        self.install_test_package("pkg-c", "3.0.0")
+        result = self.run_pkg("list", "--json")
+        data = json.loads(result.stdout)
+        self.assertEqual({p["name"] for p in data["packages"]},
+                         {"pkg-a", "pkg-b", "pkg-c"})
+
+    def test_lookup_after_remove(self):
+        """Test that every other package is still found after a removal."""
+        names = [f"pkg-{i:02d}" for i in range(12)]
+        for i, name in enumerate(names):
+            self.install_test_package(name, f"1.0.{i}")
+
+        # Removing shifts the later entries down and rebuilds the index;
+        # replaying the journal then adds and updates entries after it
+        result = self.run_pkg("remove", "pkg-05")
+        self.assertEqual(result.returncode, 0)
+        self.install_test_package("pkg-12", "1.0.12")
+        self.install_test_package("pkg-07", "2.0.0")
+
+        versions = {name: f"1.0.{i}" for i, name in enumerate(names)}
+        versions["pkg-12"] = "1.0.12"
+        versions["pkg-07"] = "2.0.0"
+        del versions["pkg-05"]
+        for name, version in versions.items():
+            data = self.run_pkg_json("info", name, "--json")
+            self.assertEqual(data.get("name"), name)
+            self.assertEqual(data.get("version"), version)
+
+        data = self.run_pkg_json("info", "pkg-05", "--json")
+        self.assertEqual(data.get("status"), "error")
+        self.assertEqual(data.get("message"), "package not installed")
+
 
 class TestPkgDbEdgeCases(PkgTestBase):
     """Test edge cases for package database."""
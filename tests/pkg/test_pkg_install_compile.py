@@ -155,6 +155,32 @@ class TestPkgInstallCompilation(PkgTestBase):
         finally:
             tarball.unlink()
 
+    def test_install_warns_about_missing_dependency(self):
+        """Test that install warns when a dependency is not installed."""
+        tarball = self.build_test_tarball("dep-user", "1.0.0",
+                                          with_source=True,
+                                          dependencies=["dep-lib"])
+        try:
+            result = self.run_pkg("install", str(tarball))
+            self.assertEqual(result.returncode, 0)
+            self.assertIn("depends on dep-lib", result.stderr)
+            self.assertPackageInstalled("dep-user", "1.0.0")
+        finally:
+            tarball.unlink()
+
+    def test_install_with_installed_dependency(self):
+        """Test that an installed dependency draws no warning."""
+        self.install_test_package("dep-lib", "1.0.0")
+        tarball = self.build_test_tarball("dep-user", "1.0.0",
+                                          with_source=True,
+                                          dependencies=["dep-lib"])
+        try:
+            result = self.run_pkg("install", str(tarball))
+            self.assertEqual(result.returncode, 0)
+            self.assertNotIn("depends on", result.stderr)
+        finally:
+            tarball.unlink()
+
     def test_installed_binary_runs_correctly(self):
         """Test that the installed binary executes correctly."""
         tarball = self.build_test_tarball("run-test", "1.0.0", with_source=True)
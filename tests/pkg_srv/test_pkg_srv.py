@@ -1,6 +1,8 @@
 #!/usr/bin/env python3
 """Unit tests for the package registry server."""
 
+import gzip
+import hashlib
 import json
 import os
 import signal
@@ -193,6 +195,71 @@ class TestPackageRegistryServer(unittest.TestCase):
             self.assertIn("description", pkg)
             self.assertIsInstance(pkg["description"], str)
 
+    def test_get_packages_has_validators(self):
+        """Test GET /packages sends an ETag and Last-Modified."""
+        response = urlopen(f"{self.BASE_URL}/packages", timeout=5)
+        self.assertTrue(response.headers.get("ETag"))
+        self.assertTrue(response.headers.get("Last-Modified"))
+
+    def test_get_packages_etag_is_stable(self):
+        """Test GET /packages sends the same ETag while nothing changes."""
+        first = urlopen(f"{self.BASE_URL}/packages", timeout=5)
+        second = urlopen(f"{self.BASE_URL}/packages", timeout=5)
+        self.assertEqual(first.headers.get("ETag"),
+                         second.headers.get("ETag"))
+
+    def test_get_packages_if_none_match_returns_304(self):
+        """Test GET /packages with a current ETag returns 304, no body."""
+        response = urlopen(f"{self.BASE_URL}/packages", timeout=5)
+        etag = response.headers.get("ETag")
+        request = Request(f"{self.BASE_URL}/packages",
+                          headers={"If-None-Match": etag})
+        try:
+            urlopen(request, timeout=5)
+            self.fail("Expected HTTPError 304")
+        except HTTPError as e:
+            self.assertEqual(e.code, 304)
+            self.assertEqual(e.read(), b"")
+
+    def test_get_packages_if_modified_since_returns_304(self):
+        """Test GET /packages with a current date returns 304."""
+        response = urlopen(f"{self.BASE_URL}/packages", timeout=5)
+        last_modified = response.headers.get("Last-Modified")
+        request = Request(f"{self.BASE_URL}/packages",
+                          headers={"If-Modified-Since": last_modified})
+        try:
+            urlopen(request, timeout=5)
+            self.fail("Expected HTTPError 304")
+        except HTTPError as e:
+            self.assertEqual(e.code, 304)
+
+    def test_get_packages_stale_etag_returns_200(self):
+        """Test GET /packages with an outdated ETag returns the listing."""
+        request = Request(f"{self.BASE_URL}/packages",
+                          headers={"If-None-Match": '"stale"'})
+        response = urlopen(request, timeout=5)
+        self.assertEqual(response.status, 200)
+        data = json.loads(response.read().decode())
+        self.assertEqual(data["status"], "ok")
+
+    def test_get_packages_gzip(self):
+        """Test GET /packages is gzipped when the client accepts it."""
+        request = Request(f"{self.BASE_URL}/packages",
+                          headers={"Accept-Encoding": "gzip"})
+        response = urlopen(request, timeout=5)
+        self.assertEqual(response.headers.get("Content-Encoding"), "gzip")
+        data = json.loads(gzip.decompress(response.read()).decode())
+        self.assertEqual(data["status"], "ok")
+        self.assertIn("packages", data)
+
+    def test_get_packages_brotli(self):
+        """Test GET /packages is brotli-compressed when preferred."""
+        request = Request(f"{self.BASE_URL}/packages",
+                          headers={"Accept-Encoding": "br"})
+        response = urlopen(request, timeout=5)
+        self.assertEqual(response.headers.get("Content-Encoding"), "br")
+        self.assertTrue(response.read())
+
     # -------------------------------------------------------------------------
     # GET /packages/:name tests (existing package)
     # -------------------------------------------------------------------------
@@ -236,6 +303,56 @@ class TestPackageRegistryServer(unittest.TestCase):
         self.assertIn("downloadUrl", data["package"])
         self.assertIn("ls", data["package"]["downloadUrl"])
 
+    def test_get_package_if_none_match_returns_304(self):
+        """Test GET /packages/ls with a current ETag returns 304."""
+        response = urlopen(f"{self.BASE_URL}/packages/ls", timeout=5)
+        etag = response.headers.get("ETag")
+        self.assertTrue(etag)
+        request = Request(f"{self.BASE_URL}/packages/ls",
+                          headers={"If-None-Match": etag})
+        try:
+            urlopen(request, timeout=5)
+            self.fail("Expected HTTPError 304")
+        except HTTPError as e:
+            self.assertEqual(e.code, 304)
+
+    def test_download_is_immutable(self):
+        """Test tarball downloads may be cached for good."""
+        url = self.fetch_json("/packages/ls")["package"]["downloadUrl"]
+        path = url[url.index("/downloads/"):]
+        response = urlopen(f"{self.BASE_URL}{path}", timeout=5)
+        self.assertIn("immutable", response.headers.get("Cache-Control"))
+
+    def test_download_range(self):
+        """Test tarball downloads honour byte ranges."""
+        url = self.fetch_json("/packages/ls")["package"]["downloadUrl"]
+        path = url[url.index("/downloads/"):]
+        request = Request(f"{self.BASE_URL}{path}",
+                          headers={"Range": "bytes=0-9"})
+        response = urlopen(request, timeout=5)
+        self.assertEqual(response.status, 206)
+        self.assertEqual(len(response.read()), 10)
+
+    def test_get_package_ls_has_binaries(self):
+        """Test GET /packages/ls lists its prebuilt tarball."""
+        data = self.fetch_json("/packages/ls")
+        binaries = data["package"]["binaries"]
+        self.assertGreater(len(binaries), 0)
+        for binary in binaries:
+            self.assertTrue(binary["platform"])
+            self.assertEqual(len(binary["sha256"]), 64)
+            self.assertIn(f"ls-0.0.1-{binary['platform']}.tar.gz",
+                          binary["downloadUrl"])
+
+    def test_binary_download(self):
+        """Test a prebuilt tarball listed for a package downloads."""
+        binary = self.fetch_json("/packages/ls")["package"]["binaries"][0]
+        url = binary["downloadUrl"]
+        path = url[url.index("/downloads/"):]
+        response = urlopen(f"{self.BASE_URL}{path}", timeout=5)
+        self.assertEqual(response.status, 200)
+        self.assertEqual(response.read()[:2], b"\x1f\x8b")
+
     def test_get_package_cat(self):
         """Test GET /packages/cat returns correct data."""
         data = self.fetch_json("/packages/cat")
@@ -243,6 +360,62 @@ class TestPackageRegistryServer(unittest.TestCase):
         self.assertEqual(data["package"]["name"], "cat")
         self.assertEqual(data["package"]["latestVersion"], "0.0.1")
 
+    # -------------------------------------------------------------------------
+    # POST /packages/versions tests
+    # -------------------------------------------------------------------------
+
+    def post_json(self, path, body):
+        """POST a JSON body to the server and return the parsed response."""
+        request = Request(f"{self.BASE_URL}{path}",
+                          data=json.dumps(body).encode(),
+                          headers={"Content-Type": "application/json"})
+        return json.loads(urlopen(request, timeout=5).read())
+
+    def test_versions_batch(self):
+        """Test POST /packages/versions answers for all names at once."""
+        data = self.post_json("/packages/versions",
+                              {"names": ["ls", "cat", "nonexistent"]})
+        self.assertEqual(data["status"], "ok")
+        self.assertEqual(data["packages"], [
+            {"name": "ls", "latestVersion": "0.0.1"},
+            {"name": "cat", "latestVersion": "0.0.1"},
+        ])
+        self.assertEqual(data["missing"], ["nonexistent"])
+
+    def test_versions_requires_names(self):
+        """Test POST /packages/versions rejects a body without names."""
+        try:
+            self.post_json("/packages/versions", {"name": "ls"})
+            self.fail("Expected HTTPError 400")
+        except HTTPError as e:
+            self.assertEqual(e.code, 400)
+
+    # -------------------------------------------------------------------------
+    # Static layout tests
+    # -------------------------------------------------------------------------
+
+    def test_static_index(self):
+        """Test the static index names a listing matching GET /packages."""
+        index = self.fetch_json("/index.json")
+        self.assertGreaterEqual(index["generation"], 1)
+        listing = self.fetch_json(f"/{index['listing']}")
+        names = [pkg["name"] for pkg in listing["packages"]]
+        self.assertEqual(names, [pkg["name"] for pkg in
+                                 self.fetch_json("/packages")["packages"]])
+        response = urlopen(f"{self.BASE_URL}/{index['listing']}", timeout=5)
+        self.assertIn("immutable", response.headers.get("Cache-Control"))
+
+    def test_static_package_blob(self):
+        """Test a sharded package file points at its tarball by digest."""
+        shard = hashlib.sha256(b"ls").hexdigest()[:2]
+        package = self.fetch_json(f"/packages/{shard}/ls.json")["package"]
+        self.assertEqual(package["name"], "ls")
+        url = package["downloadUrl"]
+        self.assertTrue(url.startswith("blobs/"))
+        response = urlopen(f"{self.BASE_URL}/{url}", timeout=5)
+        self.assertEqual(hashlib.sha256(response.read()).hexdigest(),
+                         package["sha256"])
+
     # -------------------------------------------------------------------------
     # GET /packages/:name tests (non-existent package)
     # -------------------------------------------------------------------------